@@ -10,6 +10,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <time.h>
+#include "auth_cache.h"
 
 /* User roles */
 enum user_role {
@@ -83,6 +84,8 @@ struct access_control_config {
 	bool enable_session_renewal;   /* Auto-renew sessions on activity */
 	uint32_t max_login_attempts;   /* Max failed login attempts */
 	uint32_t lockout_duration;     /* Account lockout duration (seconds) */
+	uint32_t cache_size;           /* Validated sessions cached, 0 for 1024 */
+	uint32_t cache_ttl;            /* Longest a cached session is trusted (seconds), 0 for 30 */
 };
 
 /**
@@ -321,6 +324,18 @@ void access_control_stats(struct access_control *ac,
                          size_t *total_api_keys,
                          unsigned long *failed_logins);
 
+/**
+ * access_control_cache_stats() - Get statistics of the validated session cache
+ * @ac: Access control context
+ * @stats: Output statistics
+ *
+ * Sessions that validated are cached for access_control_validate_session()
+ * and access_control_check_permission(). Renewal of a cached session is
+ * deferred to the next validation that misses the cache.
+ */
+void access_control_cache_stats(struct access_control *ac,
+                                struct auth_cache_stats *stats);
+
 /* Helper functions */
 
 /**
@@ -0,0 +1,124 @@
+/* adaptive_batch.h - Batch size and linger time steered by latency
+ *
+ * A stage that groups items before acting on them, such as committing
+ * a transaction or sending a request, keeps one controller. It asks the
+ * controller how many items make a batch and how long an open batch may
+ * wait for more, and tells it what each batch cost once done. The
+ * controller aims the time from a batch's first item to its completion
+ * at a target: it shrinks batches that miss it and grows full batches
+ * that make it with room to spare. It lingers only while the stage is
+ * busy enough for waiting to save work, and flushes at once when idle.
+ *
+ * Controllers are listed in a process-wide registry, so the size and
+ * linger time of every stage can be exported.
+ */
+
+#ifndef ADAPTIVE_BATCH_H
+#define ADAPTIVE_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Forward declarations */
+struct nlmon_stats_snapshot;
+
+/* Controller configuration, 0 takes the default unless noted */
+struct adaptive_batch_config {
+	size_t min_size;                /* Smallest batch, 1 */
+	size_t max_size;                /* Largest batch and the initial size, 256 */
+	uint64_t target_us;             /* Latency aimed for, 2 * max_linger_us or 100 ms */
+	uint64_t max_linger_us;         /* Longest wait for more items and the initial one,
+	                                 * 0 to never linger */
+};
+
+/* Controller (opaque) */
+struct adaptive_batch;
+
+/* State of a controller */
+struct adaptive_batch_stats {
+	const char *name;
+	size_t size;                    /* Current batch size */
+	uint64_t linger_us;             /* Current linger time */
+	uint64_t target_us;
+	uint64_t latency_us;            /* Moving average of batch latency */
+	uint64_t batches;
+	uint64_t items;
+	uint64_t over_target;           /* Batches that missed the target */
+	uint64_t grows;
+	uint64_t shrinks;
+};
+
+/**
+ * adaptive_batch_create() - Create a controller and register it
+ * @name: Stage name, copied
+ * @config: Configuration, or NULL for the defaults
+ *
+ * Returns: Controller or NULL on error
+ */
+struct adaptive_batch *adaptive_batch_create(const char *name,
+                                             const struct adaptive_batch_config *config);
+
+/**
+ * adaptive_batch_destroy() - Unregister and free a controller
+ * @batch: Controller (can be NULL)
+ */
+void adaptive_batch_destroy(struct adaptive_batch *batch);
+
+/**
+ * adaptive_batch_size() - Items that make a full batch
+ * @batch: Controller
+ *
+ * Safe from any thread.
+ */
+size_t adaptive_batch_size(const struct adaptive_batch *batch);
+
+/**
+ * adaptive_batch_linger_ns() - Time an open batch may wait for more items
+ * @batch: Controller
+ *
+ * Counted from the batch's first item; 0 means a batch ends as soon as
+ * no more items are at hand. Safe from any thread.
+ */
+uint64_t adaptive_batch_linger_ns(const struct adaptive_batch *batch);
+
+/**
+ * adaptive_batch_record() - Account a completed batch
+ * @batch: Controller
+ * @count: Items in the batch
+ * @wait_ns: Time from its first item until acting on it started
+ * @cost_ns: Time acting on it took
+ * @now_ns: Monotonic time of completion
+ *
+ * Adjusts the size and linger time. Called by one thread at a time, the
+ * stage's own.
+ */
+void adaptive_batch_record(struct adaptive_batch *batch, size_t count,
+                           uint64_t wait_ns, uint64_t cost_ns, uint64_t now_ns);
+
+/**
+ * adaptive_batch_get_stats() - Read the state of a controller
+ * @batch: Controller
+ * @stats: Output, name valid while the controller is
+ */
+void adaptive_batch_get_stats(const struct adaptive_batch *batch,
+                              struct adaptive_batch_stats *stats);
+
+/**
+ * adaptive_batch_for_each() - Read the state of every controller
+ * @fn: Called per controller with the registry locked
+ * @ctx: Passed to @fn
+ */
+void adaptive_batch_for_each(void (*fn)(const struct adaptive_batch_stats *stats, void *ctx),
+                             void *ctx);
+
+/**
+ * adaptive_batch_collect_stats() - Stats bus collector
+ * @snapshot: Snapshot to fill
+ * @ctx: Unused
+ *
+ * Fills the batching part, see stats_bus_add_source().
+ */
+void adaptive_batch_collect_stats(struct nlmon_stats_snapshot *snapshot, void *ctx);
+
+#endif /* ADAPTIVE_BATCH_H */
@@ -21,6 +21,7 @@
 #include <stdbool.h>
 #include <time.h>
 #include "event_processor.h"
+#include "webhook_sender.h"
 
 /* Maximum lengths */
 #define ALERT_MAX_NAME 64
@@ -29,6 +30,14 @@
 #define ALERT_MAX_MESSAGE 1024
 #define ALERT_MAX_WEBHOOK_URL 512
 
+/* Duplicate keys of one rule coalesced at once, see alert_rule.dedup_fields */
+#define ALERT_DEDUP_KEYS 64
+
+/* Event fields telling duplicate triggers of a rule apart */
+#define ALERT_DEDUP_INTERFACE    (1u << 0)
+#define ALERT_DEDUP_MESSAGE_TYPE (1u << 1)
+#define ALERT_DEDUP_EVENT_TYPE   (1u << 2)
+
 /* Alert severity levels */
 enum alert_severity {
 	ALERT_SEVERITY_INFO = 0,
@@ -70,6 +79,9 @@ struct alert_action {
 			uint32_t timeout_ms;
 		} webhook;
 	} params;
+	
+	/* Digest mode: run once per interval for all triggers in it, 0 per trigger */
+	uint32_t flush_interval_s;
 };
 
 /* Alert rule configuration */
@@ -86,6 +98,11 @@ struct alert_rule {
 	
 	/* Suppression */
 	uint32_t suppress_duration_s; /* Suppress for N seconds after trigger */
+	
+	/* Deduplication */
+	uint32_t dedup_window_s;      /* Coalesce duplicates for N seconds after an action, 0 off */
+	uint32_t dedup_fields;        /* ALERT_DEDUP_* of a duplicate key, 0 for one per rule */
+	uint32_t coalesce_count;      /* Send coalesced duplicates after N, 0 at window end */
 };
 
 /* Alert instance (triggered alert) */
@@ -109,6 +126,7 @@ struct alert_stats {
 	unsigned long total_failed;
 	unsigned long total_suppressed;
 	unsigned long total_rate_limited;
+	unsigned long total_coalesced;   /* Triggers sent in a digest of several */
 	unsigned long active_count;
 	unsigned long acknowledged_count;
 };
@@ -128,6 +146,8 @@ struct alert_manager *alert_manager_create(size_t max_rules, size_t max_history)
 /**
  * alert_manager_destroy() - Destroy alert manager
  * @am: Alert manager
+ *
+ * Sends the digests still pending, see alert_manager_flush().
  */
 void alert_manager_destroy(struct alert_manager *am);
 
@@ -173,10 +193,29 @@ bool alert_manager_disable_rule(struct alert_manager *am, int rule_id);
  * @event: Event to evaluate
  *
  * This function evaluates all enabled alert rules against the event
- * and triggers matching alerts.
+ * and triggers matching alerts. Rules whose condition requires an
+ * event_type, message_type or interface equality are only evaluated for
+ * events carrying that value. Safe to call from several threads, and
+ * never waits for rule changes.
  */
 void alert_manager_evaluate(struct alert_manager *am, struct nlmon_event *event);
 
+/**
+ * alert_manager_flush() - Send the digests that are due
+ * @am: Alert manager
+ * @force: Send all pending digests, due or not
+ *
+ * A trigger within a rule's dedup window of an earlier one with the same
+ * key does not run the action. Such duplicates are counted and sent as
+ * one digest when the window ends, or once coalesce_count of them are
+ * pending. Actions with a flush interval collect all triggers into one
+ * digest per interval. Digests run the action once with the latest
+ * event and the number of triggers (NLMON_ALERT_COUNT for scripts,
+ * "count" for webhooks). alert_manager_evaluate() flushes at most once
+ * a second; callers whose events may stop call this periodically.
+ */
+void alert_manager_flush(struct alert_manager *am, bool force);
+
 /**
  * alert_manager_acknowledge() - Acknowledge an alert
  * @am: Alert manager
@@ -232,6 +271,22 @@ size_t alert_manager_get_history(struct alert_manager *am,
  */
 bool alert_manager_get_stats(struct alert_manager *am, struct alert_stats *stats);
 
+/**
+ * alert_manager_get_webhook_stats() - Get webhook delivery statistics
+ * @am: Alert manager
+ * @stats: Output array, one entry per endpoint
+ * @max_stats: Size of @stats
+ *
+ * Webhook actions queue their payload for the delivery thread and count
+ * as executed once queued. Delivery, retries and latency are accounted
+ * per endpoint here.
+ *
+ * Returns: Number of endpoints written to @stats
+ */
+size_t alert_manager_get_webhook_stats(struct alert_manager *am,
+                                       struct webhook_endpoint_stats *stats,
+                                       size_t max_stats);
+
 /**
  * alert_manager_reset_stats() - Reset alert statistics
  * @am: Alert manager
@@ -1,7 +1,9 @@
 /* audit_log.h - Cryptographic audit log for security events
  *
  * Provides tamper-evident audit logging with cryptographic hash chaining,
- * separate security event log, and log rotation.
+ * separate security event log, and log rotation. Entries can be written
+ * in batches and closed by periodic Merkle root checkpoints, which allow
+ * parallel and range verification.
  */
 
 #ifndef AUDIT_LOG_H
@@ -11,8 +13,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-/* Forward declaration */
+/* Forward declarations */
 struct nlmon_event;
+struct io_service;
 
 /* Audit log handle (opaque) */
 struct audit_log;
@@ -23,8 +26,11 @@ struct audit_log_config {
 	const char *security_log_path;  /* Security events log path (NULL=same) */
 	size_t max_file_size;           /* Max file size before rotation (bytes) */
 	size_t max_rotations;           /* Max number of rotated files to keep */
-	bool sync_writes;               /* Sync after each write */
+	bool sync_writes;               /* Sync to disk after each batch */
 	bool verify_on_open;            /* Verify chain integrity on open */
+	size_t batch_size;              /* Entries written per batch (0=1) */
+	size_t checkpoint_interval;     /* Entries per Merkle checkpoint (0=none) */
+	struct io_service *io_service;  /* Batches written from this service (NULL=caller) */
 };
 
 /* Audit log entry severity */
@@ -77,15 +83,51 @@ bool audit_log_write_message(struct audit_log *log,
                              const char *format, ...)
                              __attribute__((format(printf, 3, 4)));
 
+/**
+ * audit_log_flush() - Write batched entries to the log files
+ * @log: Audit log handle
+ *
+ * Entries of an unfinished batch are only held in memory until the batch
+ * fills, the log is flushed, rotated or closed.
+ *
+ * With io_service set, full batches are written, and with sync_writes
+ * fdatasynced, by the service while the writer carries on. Flushing
+ * waits for the service, its result covers every batch handed over
+ * since the previous flush.
+ *
+ * Returns: true on success, false on error
+ */
+bool audit_log_flush(struct audit_log *log);
+
 /**
  * audit_log_verify() - Verify audit log integrity
  * @log_path: Path to audit log file
  * @error_line: Output for line number of first error (if any)
  *
+ * Checks the hash chain and the Merkle root of every checkpoint. Large
+ * files are split at checkpoints and verified by several threads.
+ *
  * Returns: true if log is valid, false if tampered or error
  */
 bool audit_log_verify(const char *log_path, size_t *error_line);
 
+/**
+ * audit_log_verify_range() - Verify the entries of a sequence range
+ * @log_path: Path to audit log file
+ * @first_seq: First sequence number to verify
+ * @last_seq: Last sequence number to verify
+ * @error_seq: Output for sequence number of first error (if any)
+ *
+ * Finds the range by binary search over the file and verifies only the
+ * checkpoint segments covering it, including the chain links into them.
+ * Requires sequence numbers increasing through the file, as written by
+ * audit_log_write().
+ *
+ * Returns: true if the range is valid, false if tampered or error
+ */
+bool audit_log_verify_range(const char *log_path, uint64_t first_seq,
+                            uint64_t last_seq, uint64_t *error_seq);
+
 /**
  * audit_log_rotate() - Manually rotate audit log
  * @log: Audit log handle
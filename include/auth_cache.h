@@ -0,0 +1,125 @@
+/* auth_cache.h - Cache of validated tokens
+ *
+ * Maps session IDs and tokens that passed validation to the identity they
+ * resolved to, so a request carrying one is authorized with a hash lookup
+ * instead of walking the session list or verifying a signature again.
+ *
+ * The cache is split into shards, each with its own lock and a fixed
+ * number of entries, evicting in insertion order when full. An entry
+ * lives until the earlier of its token's own expiry and the cache TTL,
+ * so changes made behind the cache's back are picked up within the TTL.
+ * Logouts and role changes invalidate entries right away.
+ */
+
+#ifndef AUTH_CACHE_H
+#define AUTH_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define AUTH_CACHE_TOKEN_MAX 320   /* Longer tokens are not cached */
+
+/* Identity a token resolved to */
+struct auth_identity {
+	char username[64];
+	char role[32];
+	uint32_t permissions;
+};
+
+/* Cache statistics */
+struct auth_cache_stats {
+	size_t entries;
+	size_t capacity;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t insertions;
+	uint64_t evictions;       /* Entries pushed out by newer ones */
+	uint64_t invalidations;   /* Entries removed by an invalidation */
+};
+
+/* Token cache (opaque) */
+struct auth_cache;
+
+/**
+ * auth_cache_create() - Create a token cache
+ * @capacity: Maximum number of entries, 0 for 1024
+ * @ttl: Longest time an entry is trusted in seconds, 0 for 30
+ *
+ * Returns: Pointer to cache or NULL on error
+ */
+struct auth_cache *auth_cache_create(size_t capacity, uint32_t ttl);
+
+/**
+ * auth_cache_destroy() - Destroy a token cache
+ * @cache: Cache (can be NULL)
+ */
+void auth_cache_destroy(struct auth_cache *cache);
+
+/**
+ * auth_cache_lookup() - Look up a validated token
+ * @cache: Cache
+ * @token: Token presented by a request
+ * @identity: Output for the identity it resolved to (optional)
+ *
+ * Returns: true on a hit, false if the token has to be validated
+ */
+bool auth_cache_lookup(struct auth_cache *cache, const char *token,
+                       struct auth_identity *identity);
+
+/**
+ * auth_cache_generation() - Get the invalidation generation
+ * @cache: Cache
+ *
+ * Taken before validating a token and handed to auth_cache_insert(), so
+ * a result that an invalidation overtook is not cached.
+ *
+ * Returns: Current generation
+ */
+uint64_t auth_cache_generation(struct auth_cache *cache);
+
+/**
+ * auth_cache_insert() - Cache a validated token
+ * @cache: Cache
+ * @token: Token that passed validation
+ * @identity: Identity it resolved to
+ * @expires: When the token itself expires, 0 if it does not
+ * @generation: auth_cache_generation() from before the validation
+ *
+ * Nothing is cached if an invalidation happened since @generation.
+ */
+void auth_cache_insert(struct auth_cache *cache, const char *token,
+                       const struct auth_identity *identity, time_t expires,
+                       uint64_t generation);
+
+/**
+ * auth_cache_invalidate() - Forget a token, on logout
+ * @cache: Cache
+ * @token: Token
+ */
+void auth_cache_invalidate(struct auth_cache *cache, const char *token);
+
+/**
+ * auth_cache_invalidate_user() - Forget the tokens of a user
+ * @cache: Cache
+ * @username: User whose role, permissions or account changed
+ *
+ * Returns: Number of entries removed
+ */
+size_t auth_cache_invalidate_user(struct auth_cache *cache, const char *username);
+
+/**
+ * auth_cache_clear() - Forget all tokens
+ * @cache: Cache
+ */
+void auth_cache_clear(struct auth_cache *cache);
+
+/**
+ * auth_cache_get_stats() - Get cache statistics
+ * @cache: Cache
+ * @stats: Output statistics
+ */
+void auth_cache_get_stats(struct auth_cache *cache, struct auth_cache_stats *stats);
+
+#endif /* AUTH_CACHE_H */
@@ -0,0 +1,225 @@
+/* binary_export.h - Compact binary event export with an mmap reader
+ *
+ * A binary export file is a header, a schema block and a sequence of
+ * length-prefixed records, all in host byte order and 8-byte aligned so
+ * a reader can use them in place from an mmap of the file:
+ *
+ *   struct binexp_file_header
+ *   struct binexp_field[field_count]   layout of struct binexp_event
+ *   records...                         struct binexp_record + payload
+ *
+ * An event record is a fixed struct binexp_event, optionally followed by
+ * the raw netlink message. Interface and generic netlink family names are
+ * written once each as a name record assigning them a dictionary id,
+ * ahead of the first event that refers to them.
+ *
+ * The reader checks the schema against the layout it was built with and
+ * iterates over the mapping without allocating, returning pointers into
+ * it. A record cut short by a crash ends the iteration.
+ */
+
+#ifndef BINARY_EXPORT_H
+#define BINARY_EXPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Forward declaration */
+struct nlmon_event;
+
+#define BINEXP_MAGIC "NLMONBIN"
+#define BINEXP_VERSION 2
+
+/* Dictionary ids, BINEXP_NO_NAME for an empty or unrecorded name */
+#define BINEXP_MAX_NAMES 4096
+#define BINEXP_NO_NAME 0xffff
+
+/* Longest name in the dictionary, NUL included */
+#define BINEXP_NAME_SIZE 32
+
+/* Record types */
+enum binexp_record_type {
+	BINEXP_RECORD_EVENT = 1,
+	BINEXP_RECORD_NAME = 2
+};
+
+/* File header */
+struct binexp_file_header {
+	char magic[8];                  /* BINEXP_MAGIC, not NUL terminated */
+	uint16_t version;               /* BINEXP_VERSION */
+	uint16_t header_size;           /* Bytes up to the first record */
+	uint16_t field_count;           /* Schema entries */
+	uint16_t event_size;            /* sizeof(struct binexp_event) */
+	uint64_t created_ns;            /* CLOCK_REALTIME at creation */
+};
+
+/* Kinds of schema fields */
+enum binexp_field_kind {
+	BINEXP_FIELD_UINT = 1,          /* Unsigned integer */
+	BINEXP_FIELD_INT = 2,           /* Signed integer */
+	BINEXP_FIELD_NAME = 3           /* uint16_t dictionary id */
+};
+
+/* Schema entry, one per field of struct binexp_event */
+struct binexp_field {
+	char name[24];                  /* NUL terminated */
+	uint16_t offset;
+	uint8_t size;
+	uint8_t kind;                   /* enum binexp_field_kind */
+};
+
+/* Record header, length includes the header and padding to 8 bytes */
+struct binexp_record {
+	uint32_t length;
+	uint16_t type;                  /* enum binexp_record_type */
+	uint16_t reserved;
+};
+
+/* Event record payload, nlmon_event and its netlink info */
+struct binexp_event {
+	uint64_t timestamp;
+	uint64_t sequence;
+	uint32_t event_type;
+	uint16_t message_type;
+	uint16_t interface;             /* Dictionary id */
+	int32_t nl_protocol;
+	uint16_t nl_msg_type;
+	uint16_t nl_msg_flags;
+	uint32_t nl_seq;
+	uint32_t nl_pid;
+	uint8_t genl_cmd;
+	uint8_t genl_version;
+	uint16_t genl_family_id;
+	uint16_t genl_family;           /* Dictionary id */
+	uint16_t reserved;
+	uint32_t raw_len;               /* Raw netlink bytes after the event */
+	uint32_t sample_weight;         /* Events this one stands for, 0 for 1 (unsampled) */
+};
+
+/* Name record payload */
+struct binexp_name {
+	uint16_t id;
+	uint16_t len;                   /* Without the NUL */
+	char name[];                    /* NUL terminated */
+};
+
+/* Binary exporter options */
+struct binary_export_options {
+	bool include_raw;               /* Append the raw netlink message of each event */
+	size_t buffer_size;             /* Bytes buffered before a write, 0 for default */
+};
+
+/* Binary exporter handle (opaque) */
+struct binary_exporter;
+
+/* Binary reader handle (opaque) */
+struct binary_reader;
+
+/* Event returned by the reader, pointers into the mapping */
+struct binary_reader_event {
+	const struct binexp_event *event;
+	const char *interface;          /* "" without a name */
+	const char *genl_family;        /* "" without a name */
+	const void *raw;                /* NULL without a raw message */
+	size_t raw_len;
+};
+
+/**
+ * binary_exporter_create() - Create binary exporter
+ * @filename: Output filename, truncated
+ * @options: Options (NULL for defaults)
+ *
+ * Returns: Binary exporter handle or NULL on error
+ */
+struct binary_exporter *binary_exporter_create(const char *filename,
+                                               const struct binary_export_options *options);
+
+/**
+ * binary_exporter_destroy() - Flush and destroy binary exporter
+ * @exporter: Binary exporter handle
+ */
+void binary_exporter_destroy(struct binary_exporter *exporter);
+
+/**
+ * binary_exporter_write_event() - Write event to binary output
+ * @exporter: Binary exporter handle
+ * @event: Event to write
+ *
+ * Returns: true on success, false on error
+ */
+bool binary_exporter_write_event(struct binary_exporter *exporter,
+                                 const struct nlmon_event *event);
+
+/**
+ * binary_exporter_flush() - Write buffered records
+ * @exporter: Binary exporter handle
+ *
+ * Returns: true on success, false on error
+ */
+bool binary_exporter_flush(struct binary_exporter *exporter);
+
+/**
+ * binary_exporter_get_stats() - Get exporter statistics
+ * @exporter: Binary exporter handle
+ * @events_written: Output for events written
+ * @bytes_written: Output for bytes written, header included
+ * @names: Output for dictionary entries
+ *
+ * Returns: true on success, false on error
+ */
+bool binary_exporter_get_stats(struct binary_exporter *exporter,
+                               uint64_t *events_written,
+                               uint64_t *bytes_written,
+                               uint32_t *names);
+
+/**
+ * binexp_event_fill() - Convert an event to its binary layout
+ * @ev: Output
+ * @event: Event
+ *
+ * Names are left as BINEXP_NO_NAME and raw_len as 0, for the writer to set.
+ */
+void binexp_event_fill(struct binexp_event *ev, const struct nlmon_event *event);
+
+/**
+ * binary_reader_open() - Map a binary export file
+ * @filename: File to read
+ *
+ * Fails with errno EPROTO if the file is not a binary export or its
+ * schema differs from the one this reader was built with.
+ *
+ * Returns: Binary reader handle or NULL on error
+ */
+struct binary_reader *binary_reader_open(const char *filename);
+
+/**
+ * binary_reader_close() - Unmap file and destroy reader
+ * @reader: Binary reader handle
+ */
+void binary_reader_close(struct binary_reader *reader);
+
+/**
+ * binary_reader_next() - Get the next event
+ * @reader: Binary reader handle
+ * @out: Output event, valid until the reader is closed
+ *
+ * Returns: true if an event was read, false at the end of the file
+ */
+bool binary_reader_next(struct binary_reader *reader, struct binary_reader_event *out);
+
+/**
+ * binary_reader_rewind() - Start again from the first event
+ * @reader: Binary reader handle
+ */
+void binary_reader_rewind(struct binary_reader *reader);
+
+/**
+ * binary_reader_created() - Get the time the file was created
+ * @reader: Binary reader handle
+ *
+ * Returns: Nanoseconds since the epoch
+ */
+uint64_t binary_reader_created(const struct binary_reader *reader);
+
+#endif /* BINARY_EXPORT_H */
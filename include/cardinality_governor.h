@@ -0,0 +1,160 @@
+/* cardinality_governor.h - Bounds on the label sets of metrics
+ *
+ * Labels such as interface or namespace give a metric name one series per
+ * label set, which on a container host means without bound. A governor
+ * holds limits per metric name, or default ones for every name, and
+ * decides for the metric registry that owns the series:
+ *
+ * - when a new series of a name is registered, whether it is admitted or
+ *   collapses into the name's overflow series, whose labels are
+ *   CARDINALITY_OVERFLOW_LABELS, because max_series are registered;
+ * - when the metrics are read, which series are shown. Series unchanged
+ *   for stale_ms are left out, and of the rest the top_k busiest since
+ *   the previous read are shown on their own and the others folded into
+ *   the overflow series.
+ *
+ * Registries never free series, handles to them stay valid, so max_series
+ * is what bounds memory. top_k and stale_ms bound what a scrape sends.
+ */
+
+#ifndef CARDINALITY_GOVERNOR_H
+#define CARDINALITY_GOVERNOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Labels of the series taking what the limits keep out */
+#define CARDINALITY_OVERFLOW_LABELS "nlmon_overflow=\"true\""
+
+/* Limits of a metric name, 0 for none */
+struct cardinality_limits {
+	unsigned int max_series;        /* Series registered, later ones collapse */
+	unsigned int top_k;             /* Series shown on their own, the rest folded */
+	unsigned int stale_ms;          /* Series left out once unchanged this long */
+};
+
+/* What to do with a series when reading */
+enum cardinality_verdict {
+	CARDINALITY_SHOW,
+	CARDINALITY_FOLD,               /* Add to the overflow series */
+	CARDINALITY_EXPIRE,             /* Leave out */
+};
+
+/* Activity of a series, kept by the registry beside it */
+struct cardinality_series {
+	uint64_t progress;              /* Last progress seen */
+	uint64_t activity;              /* Progress since the read before */
+	uint64_t changed_ms;            /* When progress last moved */
+	enum cardinality_verdict verdict;
+};
+
+/* Statistics of a governed name */
+struct cardinality_stats {
+	const char *name;
+	uint64_t series;                /* Series admitted */
+	uint64_t rejected;              /* Registrations collapsed into the overflow series */
+	uint64_t folded;                /* Series folded at the last read */
+	uint64_t expired;               /* Series left out at the last read */
+};
+
+/* Cardinality governor (opaque) */
+struct cardinality_governor;
+
+/**
+ * cardinality_governor_create() - Create a governor without limits
+ *
+ * Returns: Governor or NULL on error
+ */
+struct cardinality_governor *cardinality_governor_create(void);
+
+/**
+ * cardinality_governor_destroy() - Destroy a governor
+ * @gov: Governor (can be NULL)
+ */
+void cardinality_governor_destroy(struct cardinality_governor *gov);
+
+/**
+ * cardinality_governor_set_limits() - Set the limits of a metric name
+ * @gov: Governor
+ * @name: Metric name, NULL for the default of names without their own
+ * @limits: Limits, all 0 to lift them
+ *
+ * Series registered before count against max_series only if they were
+ * registered while the name had limits.
+ *
+ * Returns: true on success, false on error
+ */
+bool cardinality_governor_set_limits(struct cardinality_governor *gov, const char *name,
+                                     const struct cardinality_limits *limits);
+
+/**
+ * cardinality_governor_active() - Whether any name has limits
+ * @gov: Governor (can be NULL)
+ *
+ * Returns: false if reading can skip cardinality_governor_select()
+ */
+bool cardinality_governor_active(struct cardinality_governor *gov);
+
+/**
+ * cardinality_governor_admit() - Decide on a new series
+ * @gov: Governor (can be NULL)
+ * @name: Metric name
+ *
+ * Called once per series the registry is about to create, other than
+ * overflow series. A refusal is counted, the caller then hands out the
+ * overflow series instead.
+ *
+ * Returns: true to create the series, false to collapse it
+ */
+bool cardinality_governor_admit(struct cardinality_governor *gov, const char *name);
+
+/**
+ * cardinality_series_init() - Start tracking a new series
+ * @series: Series activity
+ * @now_ms: Current monotonic time
+ */
+void cardinality_series_init(struct cardinality_series *series, uint64_t now_ms);
+
+/**
+ * cardinality_series_update() - Note the progress of a series
+ * @series: Series activity
+ * @progress: Counter value or observation count, bits of a gauge value
+ * @monotonic: Whether @progress only grows, else any change is one unit
+ * @now_ms: Current monotonic time
+ *
+ * Called once per read, before cardinality_governor_select().
+ */
+void cardinality_series_update(struct cardinality_series *series, uint64_t progress,
+                               bool monotonic, uint64_t now_ms);
+
+/**
+ * cardinality_governor_select() - Decide which series of a name to show
+ * @gov: Governor
+ * @name: Metric name
+ * @series: The name's series other than its overflow series, reordered
+ * @n: Number of series
+ * @now_ms: Current monotonic time
+ *
+ * Sets the verdict of every series. Ties in activity go to the series
+ * first in @series.
+ *
+ * Returns: Number of series to fold, which need an overflow series
+ */
+size_t cardinality_governor_select(struct cardinality_governor *gov, const char *name,
+                                   struct cardinality_series **series, size_t n,
+                                   uint64_t now_ms);
+
+/**
+ * cardinality_governor_for_each() - Read the statistics of governed names
+ * @gov: Governor
+ * @fn: Called per name with limits, the stats valid until it returns
+ * @ctx: Context for @fn
+ *
+ * The lock is not held while @fn runs, it can admit series.
+ */
+void cardinality_governor_for_each(struct cardinality_governor *gov,
+                                   void (*fn)(const struct cardinality_stats *stats, void *ctx),
+                                   void *ctx);
+
+#endif /* CARDINALITY_GOVERNOR_H */
@@ -0,0 +1,169 @@
+/* cli_control.h - Binary control protocol over a Unix socket
+ *
+ * A running nlmon answers local clients on a SOCK_SEQPACKET socket. Each
+ * packet is one request, response or event: a cli_control_hdr followed
+ * by a fixed payload struct, so there is no framing to parse and nothing
+ * to escape. Both ends run on the same host, integers are in host order.
+ *
+ * Requests are answered in order, with the request's type and id and a
+ * status of 0 or a negative errno. Listings answer with a packet per
+ * item followed by CLI_CONTROL_END. A subscription adds EVENT packets,
+ * sent without waiting for the client: one that does not keep up loses
+ * events and finds their number in the next event it gets.
+ *
+ * Events reach the server through a cli_feed, so publishing never blocks
+ * the event thread on the socket or on a slow client.
+ */
+
+#ifndef CLI_CONTROL_H
+#define CLI_CONTROL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define CLI_CONTROL_VERSION 1
+
+/* Socket of nlmon -K and nlmon_ctl unless given */
+#define CLI_CONTROL_DEFAULT_PATH "/run/nlmon-control.sock"
+
+/* Largest packet either side sends */
+#define CLI_CONTROL_MAX_PACKET 1024
+
+/* Clients served at once, further connections are closed */
+#define CLI_CONTROL_MAX_CLIENTS 16
+
+/* Recent events kept for CLI_CONTROL_QUERY */
+#define CLI_CONTROL_HISTORY 1024
+
+/* Forward declarations */
+struct nlmon_event;
+struct stats_bus;
+struct filter_manager;
+
+/* Packet types */
+enum cli_control_type {
+    CLI_CONTROL_HELLO = 1,      /* u32 version, answered with the server's */
+    CLI_CONTROL_STATS,          /* Answered with cli_control_stats */
+    CLI_CONTROL_FILTER_LIST,    /* FILTER packets, then END */
+    CLI_CONTROL_FILTER_ADD,     /* cli_control_filter, an error text on failure */
+    CLI_CONTROL_FILTER_REMOVE,  /* cli_control_filter, name only */
+    CLI_CONTROL_SUBSCRIBE,      /* cli_control_filter, name only, empty for all events */
+    CLI_CONTROL_UNSUBSCRIBE,
+    CLI_CONTROL_QUERY,          /* cli_control_query, EVENT packets, then END */
+
+    /* From the server */
+    CLI_CONTROL_EVENT = 64,     /* cli_control_event */
+    CLI_CONTROL_FILTER,         /* cli_control_filter */
+    CLI_CONTROL_END,
+};
+
+/* Packet header */
+struct cli_control_hdr {
+    uint16_t type;              /* enum cli_control_type */
+    int16_t status;             /* 0 or -errno, in responses */
+    uint32_t id;                /* Chosen by the client, echoed in the response */
+    uint32_t len;               /* Payload bytes after the header */
+};
+
+/* Counters of CLI_CONTROL_STATS */
+struct cli_control_stats {
+    uint64_t published;         /* Events published to the server */
+    uint64_t link_events;
+    uint64_t route_events;
+    uint64_t addr_events;
+    uint64_t neigh_events;
+    uint64_t rule_events;
+    uint64_t missed;            /* Events the server fell behind on */
+    uint64_t dropped;           /* Events subscribers did not keep up with */
+    uint32_t clients;
+    uint32_t subscribers;
+    uint32_t filters;
+    uint32_t have_bus;          /* Whether the stats bus part is filled in */
+
+    /* Latest stats bus snapshot */
+    uint64_t events_processed;
+    uint64_t events_dropped;
+    uint64_t queue_size;
+    uint64_t netlink_messages;
+    uint64_t netlink_dropped;
+};
+
+/* A named filter */
+struct cli_control_filter {
+    char name[64];
+    char expression[512];
+    uint8_t enabled;
+    uint8_t pad[7];
+    uint64_t evaluations;
+    uint64_t matches;
+};
+
+/* Selection of CLI_CONTROL_QUERY over the recent events, empty fields match all */
+struct cli_control_query {
+    char event_type[32];        /* Substring of the event type */
+    char interface[64];         /* Exact interface */
+    char text[128];             /* Substring of the message */
+    uint64_t after_seq;         /* Only events after this one */
+    uint32_t max_results;       /* 0 for all */
+    uint32_t pad;
+};
+
+/* An event, as the CLI shows it */
+struct cli_control_event {
+    uint64_t seq;               /* Position in the server's feed, from 1 */
+    uint64_t missed;            /* Events this client lost before this one */
+    char timestamp[32];
+    char event_type[32];
+    char interface[64];
+    char message[256];
+};
+
+/* What the server answers from, all optional */
+struct cli_control_context {
+    struct stats_bus *stats_bus;          /* Adds the bus part of STATS */
+    struct filter_manager *filter_mgr;    /* Filters of FILTER_* and SUBSCRIBE */
+};
+
+/* Server (opaque) */
+struct cli_control_server;
+
+/* Listen on path, replacing a stale socket, and serve from a thread named
+ * "control". NULL on error. */
+struct cli_control_server *cli_control_server_create(const char *path,
+                                                     const struct cli_control_context *ctx);
+
+/* Stop serving, close the clients and remove the socket */
+void cli_control_server_destroy(struct cli_control_server *srv);
+
+/* Publish an event to subscribers, from the single thread processing
+ * events. Never blocks. event gives the filters of filtered subscriptions
+ * something to evaluate, events without one only reach unfiltered ones. */
+void cli_control_publish(struct cli_control_server *srv, struct nlmon_event *event,
+                         const char *event_type, const char *interface,
+                         const char *message);
+
+/* Whether anyone subscribed, to skip formatting events nobody gets */
+bool cli_control_has_subscribers(struct cli_control_server *srv);
+
+/* Client side, see cli_control_client.c */
+
+/* Connect to a server. Returns the socket, -1 with errno set on error. */
+int cli_control_connect(const char *path);
+
+/* Send a packet. Returns 0, -1 with errno set on error. */
+int cli_control_send(int fd, uint16_t type, uint32_t id, const void *payload, size_t len);
+
+/* Receive a packet, waiting up to timeout_ms (-1 for ever). Returns the
+ * payload length, 0 on timeout with hdr->type 0, -1 with errno set on
+ * error or ECONNRESET once the server is gone. */
+ssize_t cli_control_recv(int fd, struct cli_control_hdr *hdr, void *payload, size_t max,
+                         int timeout_ms);
+
+/* Send a request and wait for its response, skipping events. Returns the
+ * response status, -errno if it could not be exchanged. */
+int cli_control_call(int fd, uint16_t type, const void *req, size_t req_len,
+                     void *resp, size_t resp_max);
+
+#endif /* CLI_CONTROL_H */
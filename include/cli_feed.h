@@ -0,0 +1,72 @@
+/* cli_feed.h - Snapshot channel from event processing to the CLI
+ *
+ * A single-producer, single-consumer ring of display records, formatted
+ * by the producer, plus a snapshot of the event counters. The producer
+ * never waits for the consumer: when the ring is full the oldest record
+ * is overwritten, and a consumer that fell behind skips what it missed.
+ * Each slot and the counter snapshot are guarded by a sequence count,
+ * so neither side takes a lock and a slow TUI cannot hold up events.
+ */
+
+#ifndef CLI_FEED_H
+#define CLI_FEED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Default number of records, enough for several frames of a burst */
+#define CLI_FEED_DEFAULT_CAPACITY 512
+
+/* Display record, field sizes match cli_event_entry_t */
+struct cli_feed_record {
+    uint64_t seq;               /* Position in the feed, from 1 */
+    uint64_t tags;              /* Producer's bits, see cli_feed_publish_tagged() */
+    char timestamp[32];
+    char event_type[32];
+    char interface[64];
+    char message[256];
+    char details_json[2048];
+};
+
+/* Counters of all published events, missed records included */
+struct cli_feed_stats {
+    uint64_t published;
+    uint64_t link_events;
+    uint64_t route_events;
+    uint64_t addr_events;
+    uint64_t neigh_events;
+    uint64_t rule_events;
+};
+
+/* Feed (opaque) */
+struct cli_feed;
+
+/* Create a feed of capacity records (rounded up to a power of 2, 0 for
+ * the default). Returns NULL on error. */
+struct cli_feed *cli_feed_create(size_t capacity);
+
+/* Destroy a feed, both sides must be done with it */
+void cli_feed_destroy(struct cli_feed *feed);
+
+/* Publish an event, from the producer thread only. Never blocks; the
+ * oldest record is overwritten when the consumer has not caught up. */
+void cli_feed_publish(struct cli_feed *feed, const char *timestamp,
+                      const char *event_type, const char *interface,
+                      const char *message, const char *details_json);
+
+/* Publish an event with tags for the consumer, as cli_feed_publish() */
+void cli_feed_publish_tagged(struct cli_feed *feed, uint64_t tags, const char *timestamp,
+                             const char *event_type, const char *interface,
+                             const char *message, const char *details_json);
+
+/* Read the record after *cursor (0 to start), from the consumer thread
+ * only. Records overwritten before they could be read are skipped and
+ * added to *missed if given. Returns false once caught up. */
+bool cli_feed_next(struct cli_feed *feed, uint64_t *cursor,
+                   struct cli_feed_record *record, uint64_t *missed);
+
+/* Get a consistent snapshot of the counters, from any thread */
+void cli_feed_get_stats(struct cli_feed *feed, struct cli_feed_stats *stats);
+
+#endif /* CLI_FEED_H */
@@ -2,6 +2,7 @@
 #define CLI_INTEGRATION_H
 
 #include <stdbool.h>
+#include "plugin_manager.h"
 
 /* Initialize enhanced CLI interface */
 int cli_enhanced_init(void);
@@ -9,10 +10,20 @@ int cli_enhanced_init(void);
 /* Cleanup enhanced CLI interface */
 void cli_enhanced_cleanup(void);
 
-/* Log an event to the enhanced CLI */
+/* Log an event to the enhanced CLI. Never blocks on the UI; must be
+ * called from a single thread, the one processing events. */
 void cli_enhanced_log_event(const char *event_type, const char *interface,
                             const char *message, const char *details_json);
 
+/* Show plugin statistics from a plugin manager in the CLI (NULL to stop) */
+void cli_enhanced_set_plugin_manager(plugin_manager_t *mgr);
+
+/* Run the CLI as its own process on the events of a daemon serving the
+ * control socket at path (see cli_control.h): shows the recent events,
+ * then follows new ones until the user quits or the daemon goes away.
+ * Returns 0, or -1 if the daemon could not be reached. */
+int cli_enhanced_attach(const char *path);
+
 /* Check if CLI is running */
 bool cli_enhanced_is_running(void);
 
@@ -4,10 +4,15 @@
 #include <ncurses.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+
+/* Target time between rendered frames */
+#define CLI_FRAME_INTERVAL_MS 50
 
 /* Forward declarations */
 struct nlmon_event;
 struct nlmon_filter;
+struct cli_feed;
 
 /* Panel types */
 typedef enum {
@@ -38,6 +43,7 @@ typedef struct cli_event_entry {
     char message[256];
     char details_json[2048];
     int color_pair;
+    unsigned long seq;          /* Arrival number, identifies the row */
     struct cli_event_entry *next;
 } cli_event_entry_t;
 
@@ -92,6 +98,8 @@ typedef struct {
     
     /* Event list */
     cli_event_entry_t *events;
+    cli_event_entry_t *events_tail;
+    unsigned long next_seq;
     int event_count;
     int event_capacity;
     int event_scroll;
@@ -113,6 +121,26 @@ typedef struct {
     unsigned long addr_events;
     unsigned long neigh_events;
     unsigned long rule_events;
+    unsigned long event_rate;      /* Events per second, last window */
+    
+    /* Rendering: events arriving between frames are only counted, and
+     * each frame rewrites just the event rows whose content changed */
+    int frame_interval_ms;
+    bool full_redraw;
+    unsigned long *row_keys;       /* What each events panel row shows */
+    int row_key_count;
+    unsigned long window_events;   /* Events since rate_window_start */
+    long long rate_window_start;
+    unsigned long frames_rendered;
+    
+    /* Snapshot feed drained by each frame, see cli_attach_feed() */
+    struct cli_feed *feed;
+    uint64_t feed_cursor;
+    unsigned long feed_missed;     /* Records overwritten before drawn */
+    
+    /* Source of the plugin statistics dialog */
+    size_t (*plugin_report)(void *ctx, char *buf, size_t len);
+    void *plugin_report_ctx;
     
     /* State flags */
     bool running;
@@ -137,11 +165,13 @@ void cli_resize_panels(cli_state_t *state);
 void cli_set_focus(cli_state_t *state, panel_type_t panel);
 void cli_refresh_panel(cli_state_t *state, panel_type_t panel);
 void cli_refresh_all(cli_state_t *state);
+void cli_render_frame(cli_state_t *state);
 
 /* Event management */
 int cli_add_event(cli_state_t *state, const char *timestamp, const char *event_type,
                   const char *interface, const char *message, const char *details_json);
 void cli_clear_events(cli_state_t *state);
+void cli_attach_feed(cli_state_t *state, struct cli_feed *feed);
 void cli_sort_events(cli_state_t *state);
 cli_event_entry_t *cli_get_selected_event(cli_state_t *state);
 
@@ -163,6 +193,9 @@ void cli_show_context_help(cli_state_t *state);
 void cli_show_general_help(WINDOW *help_win, int *line_ptr);
 void cli_show_filter_dialog(cli_state_t *state);
 void cli_show_export_dialog(cli_state_t *state);
+void cli_show_plugin_dialog(cli_state_t *state);
+void cli_set_plugin_report(cli_state_t *state,
+                           size_t (*report)(void *ctx, char *buf, size_t len), void *ctx);
 
 /* Search functions */
 void cli_start_search(cli_state_t *state);
@@ -10,6 +10,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include <time.h>
 
 /* Forward declarations */
@@ -30,12 +31,30 @@ struct pattern_detector;
 /* Anomaly detector */
 struct anomaly_detector;
 
-/* Correlation result */
+/* Correlation ID, unique in the process, 0 for none
+ *
+ * The high bits number the block of IDs a thread took, the low
+ * CORRELATION_ID_BLOCK_BITS count within the block, see
+ * correlation_id_next().
+ */
+typedef uint64_t correlation_id_t;
+
+/* IDs a thread hands out before it takes another block */
+#define CORRELATION_ID_BLOCK_BITS 16
+
+/* Text form of a correlation ID, as written to exports */
+#define CORRELATION_ID_FMT "%016" PRIx64
+
+/* Correlation result, a fixed-size record
+ *
+ * The rule is referenced, not copied, so records are cheap to pass along
+ * with the events they correlate and to keep.
+ */
 struct correlation_result {
-	char correlation_id[64];
+	correlation_id_t id;
+	int rule_id;
+	const char *rule_name;        /* Rule's name, valid while the engine lives */
 	size_t event_count;
-	struct nlmon_event **events;
-	char rule_name[64];
 	time_t first_timestamp;
 	time_t last_timestamp;
 };
@@ -54,13 +73,40 @@ struct pattern_result {
 struct anomaly_result {
 	char anomaly_type[64];
 	uint32_t event_type;
+	char interface[16];           /* Empty for the baseline over all interfaces */
 	double score;
 	double baseline_mean;
 	double baseline_stddev;
+	double baseline_p99;          /* 99th percentile of all intervals seen */
 	double current_value;
 	time_t detected_at;
 };
 
+/* Limits of anomaly baselines, see anomaly_detector_create() */
+#define ANOMALY_MAX_BASELINES 512     /* Event type and interface pairs */
+#define ANOMALY_MIN_SAMPLES 32        /* Intervals before a baseline is used */
+#define ANOMALY_EWMA_SAMPLES 64       /* Intervals the averages span */
+
+/* Limits of event sequence patterns, see pattern_detector_add_sequence() */
+#define PATTERN_SEQUENCE_MAX_STEPS 8
+#define PATTERN_MAX_SEQUENCES 32
+#define PATTERN_SEQUENCE_KEYS 256     /* Interfaces with live partial matches */
+
+/* One step of an event sequence, 0 fields match anything */
+struct pattern_step {
+	uint32_t event_type;
+	uint16_t message_type;
+};
+
+/* Event sequence pattern: steps in order within a time limit */
+struct pattern_sequence_def {
+	char name[64];
+	struct pattern_step steps[PATTERN_SEQUENCE_MAX_STEPS];
+	size_t step_count;
+	time_t within_sec;            /* From the first step to the last */
+	bool same_interface;          /* All steps on one interface */
+};
+
 /* Correlation rule condition */
 enum correlation_condition {
 	CORR_COND_EVENT_TYPE,
@@ -90,11 +136,18 @@ struct correlation_rule_def {
 	bool generate_alert;
 };
 
+/* Default number of shards of per-interface correlation state */
+#define CORRELATION_DEFAULT_SHARDS 16
+
+/* Most interfaces one shard keeps state for, the least recent is dropped */
+#define CORRELATION_SHARD_KEYS 64
+
 /* Correlation engine configuration */
 struct correlation_config {
 	size_t max_window_size;
 	time_t default_window_sec;
 	size_t max_rules;
+	size_t shard_count;           /* Lock-striped shards (0=CORRELATION_DEFAULT_SHARDS) */
 	bool enable_pattern_detection;
 	bool enable_anomaly_detection;
 	size_t pattern_min_frequency;
@@ -196,7 +249,12 @@ void correlation_engine_remove_rule(struct correlation_engine *engine, int rule_
  * @results: Output array for correlation results
  * @max_results: Maximum results to return
  *
- * Returns: Number of correlations found
+ * Rules with a CORR_COND_SAME_INTERFACE condition count the events of
+ * each interface on their own, the others count all events. Safe to call
+ * from several threads; events of interfaces in different shards only
+ * contend on the short update of rules over all events.
+ *
+ * Returns: Number of correlations found, per-interface rules first
  */
 size_t correlation_engine_process(struct correlation_engine *engine,
                                   struct nlmon_event *event,
@@ -204,17 +262,16 @@ size_t correlation_engine_process(struct correlation_engine *engine,
                                   size_t max_results);
 
 /**
- * correlation_engine_generate_id() - Generate correlation ID
- * @engine: Correlation engine
- * @rule_name: Rule name
- * @id_buf: Buffer for correlation ID
- * @buf_size: Buffer size
+ * correlation_id_next() - Generate correlation ID
  *
- * Returns: true on success
+ * Each thread takes blocks of 2^CORRELATION_ID_BLOCK_BITS IDs from one
+ * shared counter and hands them out without further synchronization.
+ * IDs of one thread increase; IDs of different threads are unique but
+ * not ordered.
+ *
+ * Returns: New ID, never 0
  */
-bool correlation_engine_generate_id(struct correlation_engine *engine,
-                                    const char *rule_name,
-                                    char *id_buf, size_t buf_size);
+correlation_id_t correlation_id_next(void);
 
 /**
  * pattern_detector_create() - Create pattern detector
@@ -246,11 +303,41 @@ size_t pattern_detector_process(struct pattern_detector *detector,
                                struct pattern_result *results,
                                size_t max_results);
 
+/**
+ * pattern_detector_add_sequence() - Add an event sequence pattern
+ * @detector: Pattern detector
+ * @def: Sequence definition, copied
+ *
+ * Sequences are compiled into an index from event type and message type
+ * to the steps they complete. Each interface, or the detector as a whole
+ * for sequences not on the same interface, keeps the start time of the
+ * most recent partial match per step, so an event costs O(1) in the
+ * window length and only touches the sequences waiting for it. Reported
+ * by pattern_detector_process() under the sequence's name, with the
+ * number of times it matched as the frequency; matches do not overlap.
+ *
+ * Adding a sequence drops all partial matches.
+ *
+ * Returns: Sequence ID or -1 on error
+ */
+int pattern_detector_add_sequence(struct pattern_detector *detector,
+                                  const struct pattern_sequence_def *def);
+
 /**
  * anomaly_detector_create() - Create anomaly detector
  * @baseline_window_sec: Time window for baseline calculation
  * @threshold: Anomaly score threshold (standard deviations)
  *
+ * Event rates are measured over consecutive intervals of
+ * @baseline_window_sec, per event type over all interfaces and per event
+ * type and interface. Each interval updates the baseline in constant time
+ * and memory: an exponentially weighted mean and variance over about
+ * ANOMALY_EWMA_SAMPLES intervals, the same for the interval's hour of the
+ * day (UTC), and a streaming 99th percentile. Rates are scored against
+ * the hour's baseline once it has ANOMALY_MIN_SAMPLES intervals, before
+ * that against the overall one. At most ANOMALY_MAX_BASELINES baselines
+ * are kept, the least recently used is replaced.
+ *
  * Returns: Pointer to anomaly detector or NULL on error
  */
 struct anomaly_detector *anomaly_detector_create(time_t baseline_window_sec,
@@ -269,6 +356,9 @@ void anomaly_detector_destroy(struct anomaly_detector *detector);
  * @results: Output array for anomaly results
  * @max_results: Maximum results to return
  *
+ * Reports a rate above the baseline as soon as the current interval
+ * exceeds it, and a rate below the baseline when the interval ends.
+ *
  * Returns: Number of anomalies detected
  */
 size_t anomaly_detector_process(struct anomaly_detector *detector,
@@ -281,6 +371,9 @@ size_t anomaly_detector_process(struct anomaly_detector *detector,
  * @detector: Anomaly detector
  * @event_type: Event type to update
  * @value: Value to add to baseline
+ *
+ * Adds @value as one interval's rate to the baseline of @event_type over
+ * all interfaces, in the current hour of the day.
  */
 void anomaly_detector_update_baseline(struct anomaly_detector *detector,
                                       uint32_t event_type,
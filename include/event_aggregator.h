@@ -0,0 +1,122 @@
+/* event_aggregator.h - Time-ordered merge of the event streams of many nodes
+ *
+ * The aggregator is the central side of event streaming (event_stream.h).
+ * Its collector workers decode the batches of different nodes in
+ * parallel, and one merge thread hands the events of all nodes on in
+ * timestamp order: to the storage layer, the correlation engine, the
+ * alert manager and a callback, so correlation sees every node at once.
+ *
+ * Each node's events are taken to be in time order, as its exporter sends
+ * them. An event is released once every node heard from within the
+ * reorder delay has sent one at least as late, or once it has waited the
+ * reorder delay. The reorder buffer holds a bounded number of events;
+ * when it is full the collector workers wait for room, which holds the
+ * exporters back over TCP instead of dropping events.
+ */
+
+#ifndef EVENT_AGGREGATOR_H
+#define EVENT_AGGREGATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "event_stream.h"
+
+/* Forward declarations */
+struct nlmon_event;
+struct storage_layer;
+struct correlation_engine;
+struct correlation_result;
+struct alert_manager;
+
+#define EVENT_AGGREGATOR_DELAY_MS 200           /* Default reorder delay */
+#define EVENT_AGGREGATOR_CAPACITY (512 * 1024)  /* Default events buffered */
+
+/**
+ * typedef event_aggregator_fn - Receiver of merged events
+ * @node: Node that sent the event
+ * @event: Event, valid until the call returns
+ * @ctx: Aggregator context
+ *
+ * Called on the merge thread, in timestamp order across nodes.
+ */
+typedef void (*event_aggregator_fn)(const char *node, struct nlmon_event *event, void *ctx);
+
+/**
+ * typedef event_aggregator_correlation_fn - Receiver of correlations found
+ * @node: Node of the event that completed them
+ * @results: Correlations, see correlation_engine_process()
+ * @count: Number of correlations
+ * @ctx: Aggregator context
+ */
+typedef void (*event_aggregator_correlation_fn)(const char *node,
+                                                const struct correlation_result *results,
+                                                size_t count, void *ctx);
+
+/* Aggregator configuration, zero fields take the defaults */
+struct event_aggregator_config {
+	/* Where to listen; fn, batch_fn and ctx are the aggregator's */
+	struct event_collector_config collector;    /* workers: online CPUs by default */
+	unsigned int reorder_delay_ms;
+	size_t reorder_capacity;
+
+	/* Consumers of the merged stream, each optional */
+	struct storage_layer *storage;              /* Needs a build with ENABLE_STORAGE */
+	struct correlation_engine *correlation;
+	struct alert_manager *alerts;
+	event_aggregator_fn fn;
+	event_aggregator_correlation_fn on_correlation;
+	void *ctx;
+};
+
+/* Aggregator statistics */
+struct event_aggregator_stats {
+	struct event_collector_stats collector;
+	uint64_t events_in;             /* Events received */
+	uint64_t events_out;            /* Events handed on */
+	uint64_t late;                  /* Handed on after a later event */
+	uint64_t expired;               /* Released by the reorder delay */
+	uint64_t stalls;                /* Batches that waited for room */
+	uint64_t dropped;               /* Events lost to allocation failures */
+	uint64_t correlations;
+	uint64_t buffered;              /* Events in the reorder buffer now */
+	uint64_t buffered_max;
+	uint32_t nodes;
+};
+
+/* Aggregator handle (opaque) */
+struct event_aggregator;
+
+/**
+ * event_aggregator_create() - Start the merge thread and the collector
+ * @config: Configuration
+ *
+ * Merged events carry the name of their node in user_data.
+ *
+ * Returns: Aggregator handle or NULL on error
+ */
+struct event_aggregator *event_aggregator_create(const struct event_aggregator_config *config);
+
+/**
+ * event_aggregator_destroy() - Stop collecting and hand on what is buffered
+ * @agg: Aggregator handle
+ */
+void event_aggregator_destroy(struct event_aggregator *agg);
+
+/**
+ * event_aggregator_port() - Port the collector listens on
+ * @agg: Aggregator handle
+ *
+ * Returns: Port in host byte order
+ */
+uint16_t event_aggregator_port(const struct event_aggregator *agg);
+
+/**
+ * event_aggregator_get_stats() - Get aggregator statistics
+ * @agg: Aggregator handle
+ * @stats: Output
+ */
+void event_aggregator_get_stats(struct event_aggregator *agg,
+                                struct event_aggregator_stats *stats);
+
+#endif /* EVENT_AGGREGATOR_H */
@@ -0,0 +1,215 @@
+/* event_bus.h - Shared memory event bus for local consumers
+ *
+ * nlmon publishes events into a POSIX shared memory ring that any number
+ * of local processes map and read in place. Each record is the binary
+ * export event (struct binexp_event) with its interface and generic
+ * netlink family names inline, optionally followed by the raw netlink
+ * message, so readers need no dictionary and can join at any time.
+ *
+ * There is one publisher. It never waits for readers: every reader keeps
+ * its own cursor, and one that falls more than a ring behind loses the
+ * records that were overwritten and is told how many. Slots carry a
+ * sequence number checked before and after reading, as in a seqlock, so a
+ * record overwritten while in use is detected rather than returned torn.
+ *
+ * Idle readers sleep on a futex in the shared header. The publisher only
+ * makes the wake syscall while someone is sleeping.
+ *
+ * The reader half of this header is the client library (libnlmon-bus.a),
+ * which depends on nothing else of nlmon.
+ */
+
+#ifndef EVENT_BUS_H
+#define EVENT_BUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "binary_export.h"
+
+/* Forward declaration */
+struct nlmon_event;
+
+#define EVENT_BUS_MAGIC 0x4e4c4255              /* "NLBU" */
+#define EVENT_BUS_VERSION 1
+#define EVENT_BUS_DEFAULT_NAME "/nlmon-events"
+#define EVENT_BUS_DEFAULT_SLOTS 4096            /* Records, power of two */
+#define EVENT_BUS_DEFAULT_SLOT_SIZE 512         /* Bytes per record, raw message included */
+
+/* Shared header at the start of the mapping */
+struct event_bus_header {
+	uint32_t magic;                 /* EVENT_BUS_MAGIC */
+	uint16_t version;               /* EVENT_BUS_VERSION */
+	uint16_t header_size;           /* Bytes up to the first slot */
+	uint32_t slot_count;            /* Power of two */
+	uint32_t slot_size;             /* Bytes per slot, header included */
+	uint32_t event_size;            /* sizeof(struct binexp_event) */
+	uint32_t publisher_pid;
+	uint64_t created_ns;            /* CLOCK_REALTIME at creation */
+
+	/* Written by the publisher */
+	_Atomic uint64_t head __attribute__((aligned(64)));  /* Records published */
+	_Atomic uint32_t closed;        /* Set once the publisher is gone */
+
+	/* Futex readers sleep on, bumped after each publish */
+	_Atomic uint32_t futex __attribute__((aligned(64)));
+	_Atomic uint32_t waiters;       /* Readers sleeping or about to */
+};
+
+/* Record in a slot, the raw message follows */
+struct event_bus_record {
+	struct binexp_event event;      /* raw_len is the bytes stored */
+	char interface[BINEXP_NAME_SIZE];
+	char genl_family[BINEXP_NAME_SIZE];
+};
+
+/* Slot, seq is the position + 1 of the record it holds, 0 while written */
+struct event_bus_slot {
+	_Atomic uint64_t seq;
+	struct event_bus_record record;
+};
+
+/* Publisher options, zero fields take the defaults */
+struct event_bus_options {
+	uint32_t slots;                 /* Rounded up to a power of two */
+	uint32_t slot_size;             /* Raw messages longer than what fits are cut */
+	bool include_raw;               /* Append the raw netlink message */
+	unsigned int mode;              /* Permissions of the segment, 0600 by default */
+};
+
+/* Publisher statistics */
+struct event_bus_stats {
+	uint64_t published;             /* Records written */
+	uint64_t truncated;             /* Raw messages cut to fit a slot */
+	uint64_t wakeups;               /* Wake syscalls made for sleeping readers */
+};
+
+/* Publisher handle (opaque) */
+struct event_bus;
+
+/* Reader handle (opaque) */
+struct event_bus_reader;
+
+/* Reader open flags */
+#define EVENT_BUS_FROM_OLDEST 0x1       /* Start with the oldest record still held */
+
+/**
+ * event_bus_create() - Create the shared memory segment and publish into it
+ * @name: Segment name for shm_open(), starting with '/'
+ * @options: Options (NULL for defaults)
+ *
+ * A segment left behind under @name is replaced; readers still mapping it
+ * see it closed.
+ *
+ * Returns: Publisher handle or NULL on error, with errno set
+ */
+struct event_bus *event_bus_create(const char *name, const struct event_bus_options *options);
+
+/**
+ * event_bus_destroy() - Mark the bus closed, wake readers and remove it
+ * @bus: Publisher handle
+ */
+void event_bus_destroy(struct event_bus *bus);
+
+/**
+ * event_bus_publish() - Publish an event
+ * @bus: Publisher handle
+ * @event: Event to publish
+ *
+ * Never blocks on readers. Calls from several threads are serialized.
+ *
+ * Returns: true on success, false on error
+ */
+bool event_bus_publish(struct event_bus *bus, const struct nlmon_event *event);
+
+/**
+ * event_bus_get_stats() - Get publisher statistics
+ * @bus: Publisher handle
+ * @stats: Output
+ */
+void event_bus_get_stats(struct event_bus *bus, struct event_bus_stats *stats);
+
+/**
+ * event_bus_reader_open() - Map a bus for reading
+ * @name: Segment name
+ * @flags: EVENT_BUS_* open flags, 0 to start with the next record published
+ *
+ * Fails with errno EPROTO if the segment is not an event bus of this
+ * version and layout.
+ *
+ * Returns: Reader handle or NULL on error
+ */
+struct event_bus_reader *event_bus_reader_open(const char *name, unsigned int flags);
+
+/**
+ * event_bus_reader_close() - Unmap the bus and destroy the reader
+ * @reader: Reader handle
+ */
+void event_bus_reader_close(struct event_bus_reader *reader);
+
+/**
+ * event_bus_reader_peek() - Look at the next record in place
+ * @reader: Reader handle
+ * @out: Output, a pointer into the ring
+ *
+ * Nothing is copied: the publisher may overwrite the record while the
+ * caller uses it, which event_bus_reader_release() reports. Values read
+ * from it are only trustworthy once that returned true.
+ *
+ * Returns: 0, -EAGAIN if there is nothing new, -EPIPE once the publisher
+ * is gone and everything was read
+ */
+int event_bus_reader_peek(struct event_bus_reader *reader, const struct event_bus_record **out);
+
+/**
+ * event_bus_reader_release() - Move past the record of the last peek
+ * @reader: Reader handle
+ *
+ * Returns: true if the record stayed intact while in use, false if it was
+ * overwritten and must be discarded (it counts as lost)
+ */
+bool event_bus_reader_release(struct event_bus_reader *reader);
+
+/**
+ * event_bus_reader_read() - Copy out the next record
+ * @reader: Reader handle
+ * @buf: Output for the record and its raw message
+ * @len: Size of @buf, records longer than that are cut
+ *
+ * Returns: Bytes copied, -EAGAIN, -EPIPE as event_bus_reader_peek()
+ */
+int event_bus_reader_read(struct event_bus_reader *reader, void *buf, size_t len);
+
+/**
+ * event_bus_reader_wait() - Sleep until a record is published
+ * @reader: Reader handle
+ * @timeout_ms: Longest wait, negative for none
+ *
+ * Returns: 0 when there is something to read, -ETIMEDOUT, -EINTR, -EPIPE
+ */
+int event_bus_reader_wait(struct event_bus_reader *reader, int timeout_ms);
+
+/**
+ * event_bus_reader_lost() - Records this reader missed
+ * @reader: Reader handle
+ *
+ * Returns: Records overwritten before or while they were read
+ */
+uint64_t event_bus_reader_lost(const struct event_bus_reader *reader);
+
+/**
+ * event_bus_reader_backlog() - Records published but not yet read
+ * @reader: Reader handle
+ *
+ * Returns: Backlog, capped at the ring size
+ */
+uint64_t event_bus_reader_backlog(const struct event_bus_reader *reader);
+
+/* Raw message of a record, NULL without one */
+static inline const void *event_bus_record_raw(const struct event_bus_record *record)
+{
+	return record->event.raw_len ? (const void *)(record + 1) : NULL;
+}
+
+#endif /* EVENT_BUS_H */
@@ -0,0 +1,111 @@
+/* event_cbor.h - Compact binary encoding of events for web clients
+ *
+ * Events are encoded as a CBOR sequence (RFC 8742) of small arrays, the
+ * first element telling the kind of item:
+ *
+ *   [0, timestamp, sequence, event_type, message_type, interface,
+ *    protocol, family]                         an event
+ *   [1, index, "name"]                         an interface name
+ *   [2, index, "name"]                         a generic netlink family name
+ *   [3, next_cursor, limit]                    the end of a REST listing
+ *
+ * Interface and family names are numbered in order of first use and
+ * defined once per dictionary, so an event carries them as an index. A
+ * name is null if empty and sent as text once the dictionary is full;
+ * protocol is null if unknown. Clients offer the encoding as WebSocket
+ * subprotocol EVENT_CBOR_SUBPROTOCOL or by accepting EVENT_CBOR_MEDIA_TYPE.
+ *
+ * Output goes to a json_buf, which holds any bytes. Dictionaries do not
+ * lock, callers serialize access to each.
+ */
+
+#ifndef EVENT_CBOR_H
+#define EVENT_CBOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "json_buf.h"
+
+#define EVENT_CBOR_SUBPROTOCOL "nlmon.cbor"
+#define EVENT_CBOR_MEDIA_TYPE "application/cbor-seq"
+
+#define EVENT_CBOR_DICT_MAX 256    /* Names per kind, later ones are sent as text */
+#define EVENT_CBOR_NAME_MAX 32     /* Longer names are sent as text */
+
+struct nlmon_event;
+
+/* Item kinds */
+enum event_cbor_item {
+	EVENT_CBOR_EVENT,
+	EVENT_CBOR_INTERFACE,
+	EVENT_CBOR_FAMILY,
+	EVENT_CBOR_END,
+};
+
+/* Fields of an encoded event */
+struct event_cbor_record {
+	uint64_t timestamp;
+	uint64_t sequence;
+	uint32_t event_type;
+	uint16_t message_type;
+	int protocol;                   /* NETLINK_* protocol, -1 if unknown */
+	const char *interface;          /* Need not be NUL terminated */
+	size_t interface_len;
+	const char *family;             /* Generic netlink family, NULL for none */
+	size_t family_len;
+};
+
+/* Name dictionary (opaque) */
+struct event_cbor_dict;
+
+/**
+ * event_cbor_dict_create() - Create an empty name dictionary
+ *
+ * Returns: Pointer to dictionary or NULL on error
+ */
+struct event_cbor_dict *event_cbor_dict_create(void);
+
+/**
+ * event_cbor_dict_destroy() - Destroy a name dictionary
+ * @dict: Dictionary (can be NULL)
+ */
+void event_cbor_dict_destroy(struct event_cbor_dict *dict);
+
+/**
+ * event_cbor_record_init() - Fill in a record from an event
+ * @record: Record, pointing into @event afterwards
+ * @event: Event
+ */
+void event_cbor_record_init(struct event_cbor_record *record, const struct nlmon_event *event);
+
+/**
+ * event_cbor_append() - Append an event item
+ * @out: Buffer for the event
+ * @defs: Buffer for definitions of names new to @dict, may be @out
+ * @dict: Dictionary, extended by the new names
+ * @record: Event fields
+ *
+ * The definitions must reach the client before the event, and before any
+ * later event of whoever shares @dict.
+ */
+void event_cbor_append(struct json_buf *out, struct json_buf *defs, struct event_cbor_dict *dict,
+                       const struct event_cbor_record *record);
+
+/**
+ * event_cbor_append_dict() - Append the definitions of all known names
+ * @out: Buffer
+ * @dict: Dictionary
+ *
+ * For a client joining a stream whose dictionary is already in use.
+ */
+void event_cbor_append_dict(struct json_buf *out, const struct event_cbor_dict *dict);
+
+/**
+ * event_cbor_append_end() - Append the item ending a REST listing
+ * @out: Buffer
+ * @next_cursor: Cursor of the next page, NULL if there is none
+ * @limit: Page size
+ */
+void event_cbor_append_end(struct json_buf *out, const char *next_cursor, uint64_t limit);
+
+#endif /* EVENT_CBOR_H */
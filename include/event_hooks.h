@@ -26,6 +26,13 @@
 #define HOOK_MAX_SCRIPT 256
 #define HOOK_MAX_CONDITION 512
 #define HOOK_MAX_OUTPUT 4096
+#define HOOK_MAX_LINE 512            /* Event line sent to a persistent hook */
+
+/* Default bound of a hook's queue of matched events */
+#define HOOK_DEFAULT_QUEUE 64
+
+/* Default share of events kept by HOOK_OVERFLOW_SAMPLE, 1 in N */
+#define HOOK_DEFAULT_SAMPLE_RATE 10
 
 /* Hook execution result */
 enum hook_result {
@@ -35,6 +42,13 @@ enum hook_result {
 	HOOK_RESULT_DISABLED
 };
 
+/* What a matched event does when its hook's queue is full */
+enum hook_overflow {
+	HOOK_OVERFLOW_DROP = 0,          /* Drop the new event */
+	HOOK_OVERFLOW_COALESCE,          /* Replace the newest queued event */
+	HOOK_OVERFLOW_SAMPLE,            /* From half full keep 1 in sample_rate, then drop */
+};
+
 /* Hook statistics */
 struct hook_stats {
 	unsigned long executions;
@@ -44,6 +58,11 @@ struct hook_stats {
 	unsigned long total_duration_ms;
 	unsigned long max_duration_ms;
 	unsigned long min_duration_ms;
+	unsigned long restarts;          /* Persistent hook workers restarted */
+	unsigned long queued;            /* Matched events waiting for the executor */
+	unsigned long dropped;           /* Matched events refused by a full queue */
+	unsigned long coalesced;         /* Queued events replaced by a newer one */
+	unsigned long sampled;           /* Matched events shed by sampling */
 };
 
 /* Hook configuration */
@@ -55,6 +74,13 @@ struct hook_config {
 	bool enabled;
 	bool capture_output;                 /* Capture stdout/stderr */
 	bool async;                          /* Execute asynchronously */
+	bool persistent;                     /* Feed events to one long-running process */
+	uint32_t max_concurrent;             /* Executions of this hook at once, 0 no own limit */
+	uint32_t batch_count;                /* Run once per N matching events, 0 or 1 per event */
+	uint32_t batch_interval_ms;          /* Run at latest this long after a batch's first event */
+	uint32_t queue_size;                 /* Matched events waiting to run, 0 for the default */
+	enum hook_overflow overflow;         /* Policy once the queue is full */
+	uint32_t sample_rate;                /* HOOK_OVERFLOW_SAMPLE keeps 1 in N, 0 for the default */
 };
 
 /* Hook manager structure (opaque) */
@@ -81,6 +107,23 @@ void hook_manager_destroy(struct hook_manager *hm, bool wait);
  * @hm: Hook manager
  * @config: Hook configuration
  *
+ * Scripts are started through /bin/sh -c with posix_spawn(), event
+ * fields in NLMON_* environment variables. A persistent hook instead
+ * starts its script once, with NLMON_HOOK_NAME set, and writes each
+ * matching event to its stdin as one line of JSON. Events the script
+ * has not read yet are dropped and counted as failures rather than
+ * waiting for it; a script that exits is restarted on the next event,
+ * at most once a second.
+ *
+ * A hook with batch_count or batch_interval_ms collects matching events
+ * and runs once for all of them, with the events as lines of JSON on
+ * stdin, NLMON_BATCH_COUNT set and the other variables of the latest.
+ *
+ * Matching events wait in the hook's own queue of queue_size events
+ * for the manager's executor thread; when it is full, overflow decides
+ * which event is lost. Executions of a hook that is not async run one
+ * at a time, in the order of their events.
+ *
  * Returns: Hook ID or -1 on error
  */
 int hook_manager_register(struct hook_manager *hm, const struct hook_config *config);
@@ -117,11 +160,25 @@ bool hook_manager_disable(struct hook_manager *hm, int hook_id);
  * @hm: Hook manager
  * @event: Event to process
  *
- * This function evaluates all registered hooks and executes those
- * whose conditions match the event.
+ * Evaluates the enabled hooks' conditions on a snapshot of the hooks,
+ * without taking a lock, and queues the event for those that match.
+ * It never waits for an execution; the executor thread starts them
+ * within the manager's and each hook's concurrency limits, and the
+ * reaper thread waits for them.
  */
 void hook_manager_execute(struct hook_manager *hm, struct nlmon_event *event);
 
+/**
+ * hook_manager_flush() - Run the hooks that have batched events
+ * @hm: Hook manager
+ *
+ * Batches are run when full, or by the executor once their interval
+ * has passed. This runs them early, returning once each batch that was
+ * pending has been started; hook_manager_destroy() with @wait runs what
+ * is left.
+ */
+void hook_manager_flush(struct hook_manager *hm);
+
 /**
  * hook_manager_get_stats() - Get hook statistics
  * @hm: Hook manager
@@ -164,6 +221,9 @@ bool hook_manager_get_config(struct hook_manager *hm, int hook_id,
 /**
  * hook_manager_wait() - Wait for all pending hook executions
  * @hm: Hook manager
+ *
+ * Waits until every queued event has been taken by the executor and no
+ * execution is running. Events collected in batches stay pending.
  */
 void hook_manager_wait(struct hook_manager *hm);
 
@@ -8,7 +8,9 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdatomic.h>
 #include "object_pool.h"
+#include "event_processor.h"
 
 /* Event structure for pooling */
 struct nlmon_event_pooled {
@@ -21,11 +23,16 @@ struct nlmon_event_pooled {
 	void *data;           /* Event-specific data */
 	size_t data_size;
 	void *user_data;      /* User context */
+	
+	/* Small payloads live here, see event_pool_set_data() */
+	_Alignas(max_align_t) unsigned char inline_data[NLMON_EVENT_INLINE_DATA];
 };
 
 /* Event pool wrapper */
 struct event_pool {
 	struct object_pool *pool;
+	atomic_ulong inline_hits;   /* Payloads placed inline */
+	atomic_ulong spills;        /* Payloads allocated on the heap */
 };
 
 /**
@@ -59,6 +66,30 @@ struct nlmon_event_pooled *event_pool_alloc(struct event_pool *pool);
  */
 void event_pool_free(struct event_pool *pool, struct nlmon_event_pooled *event);
 
+/**
+ * event_pool_set_data() - Copy a payload into a pooled event
+ * @pool: Event pool
+ * @event: Event without data
+ * @data: Payload to copy
+ * @size: Payload size
+ *
+ * Payloads of up to NLMON_EVENT_INLINE_DATA bytes use the event's
+ * inline area, larger ones are allocated. Freed by event_pool_free().
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int event_pool_set_data(struct event_pool *pool, struct nlmon_event_pooled *event,
+                        const void *data, size_t size);
+
+/**
+ * event_pool_get_data_stats() - Get payload placement statistics
+ * @pool: Event pool
+ * @inline_hits: Output for payloads placed inline
+ * @spills: Output for payloads allocated on the heap
+ */
+void event_pool_get_data_stats(struct event_pool *pool, unsigned long *inline_hits,
+                               unsigned long *spills);
+
 /**
  * event_pool_get_stats() - Get pool statistics
  * @pool: Event pool
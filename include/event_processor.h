@@ -10,11 +10,13 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "rate_limiter.h"
+#include "event_trace.h"
 
 /* Forward declarations */
 struct ring_buffer;
 struct thread_pool;
-struct rate_limiter_map;
+struct nlmon_stats_snapshot;
 
 /* Forward declarations for netlink data structures */
 struct nlmon_link_info;
@@ -25,6 +27,19 @@ struct nlmon_diag_info;
 struct nlmon_ct_info;
 struct nlmon_nl80211_info;
 struct nlmon_qca_vendor_info;
+struct nlmon_event;
+struct nlmon_event_shared;
+
+/* Size of the inline payload area of an event, fits link/addr/neigh info */
+#ifndef NLMON_EVENT_INLINE_DATA
+#define NLMON_EVENT_INLINE_DATA 96
+#endif
+
+/* Deferred attribute decode attached to an event by its producer */
+struct nlmon_event_lazy {
+	/* Fill netlink.data and interface, then clear netlink.lazy */
+	int (*materialize)(struct nlmon_event *event);
+};
 
 /* Event structure for processing */
 struct nlmon_event {
@@ -36,6 +51,7 @@ struct nlmon_event {
 	void *data;           /* Event-specific data */
 	size_t data_size;
 	void *user_data;      /* User context */
+	uint32_t sample_weight;  /* Events this one stands for when sampled, 0 for 1 */
 	
 	/* Netlink-specific fields */
 	struct {
@@ -44,6 +60,7 @@ struct nlmon_event {
 		uint16_t msg_flags;          /* NLM_F_* flags */
 		uint32_t seq;                /* Sequence number */
 		uint32_t pid;                /* Port ID */
+		uint64_t netns;              /* Inode of the receiving netns, 0 for our own */
 		
 		/* Generic netlink specific */
 		uint8_t genl_cmd;
@@ -63,25 +80,136 @@ struct nlmon_event {
 			struct nlmon_qca_vendor_info *qca_vendor;
 			void *generic;
 		} data;
+		
+		/* Pending decode of data, see nlmon_event_materialize() */
+		struct nlmon_event_lazy *lazy;
 	} netlink;
 	
 	/* Raw message (optional, for debugging) */
 	struct nlmsghdr *raw_msg;
 	size_t raw_msg_len;
+	
+	/* Reference count of refcounted events, see nlmon_event_share() */
+	struct nlmon_event_shared *shared;
+	
+	/* Stage timestamps while the event is traced, see event_trace.h */
+	struct nlmon_event_trace trace;
+	
+	/* Small payloads live here, see nlmon_event_copy_data() */
+	_Alignas(max_align_t) unsigned char inline_data[NLMON_EVENT_INLINE_DATA];
 };
 
 /* Event handler callback */
 typedef void (*event_handler_t)(struct nlmon_event *event, void *ctx);
 
+/* Batch event handler callback, events are in submission order per lane */
+typedef void (*event_batch_handler_t)(struct nlmon_event **events, size_t count,
+                                      void *ctx);
+
+/* Maximum number of events dispatched as one batch */
+#define EVENT_PROCESSOR_MAX_BATCH 256
+
+/* Maximum number of priority classes */
+#define EVENT_PROCESSOR_MAX_PRIORITIES 8
+
+/* Order in which priority classes are drained */
+enum event_priority_policy {
+	EVENT_PRIORITY_STRICT = 0,    /* A class only while all more urgent ones are empty */
+	EVENT_PRIORITY_WEIGHTED,      /* Each class in proportion to its weight */
+};
+
+/* Priority class configuration, class 0 is the most urgent */
+struct event_priority_class {
+	size_t capacity;              /* Class ring buffer capacity (0=ring_buffer_size) */
+	unsigned int weight;          /* Share of each weighted round (0=1) */
+};
+
+/* What submit does when the event's ring is full or filling up */
+enum event_overload_policy {
+	EVENT_OVERLOAD_DROP_NEWEST = 0, /* Refuse the new event */
+	EVENT_OVERLOAD_DROP_OLDEST,     /* Evict the oldest queued event for it */
+	EVENT_OVERLOAD_DROP_PRIORITY,   /* Above the watermark, shed less urgent classes first */
+	EVENT_OVERLOAD_SAMPLE,          /* Above the watermark, keep 1 in N per event type */
+	EVENT_OVERLOAD_BLOCK,           /* Let the producer wait for room */
+};
+
+/* Event classifier callback, returns a priority class or -1 if undecided */
+typedef int (*event_classifier_t)(const struct nlmon_event *event, void *ctx);
+
 /* Event processor configuration */
 struct event_processor_config {
 	size_t ring_buffer_size;      /* Ring buffer capacity */
 	size_t thread_pool_size;      /* Number of worker threads (0=auto) */
 	size_t work_queue_size;       /* Work queue size (0=unlimited) */
-	double rate_limit;            /* Global rate limit (events/sec, 0=none) */
+	size_t thread_pool_min;       /* Fewest workers of an elastic pool (0=1) */
+	size_t thread_pool_max;       /* Elastic pool upper bound (0=fixed size) */
+	unsigned int thread_pool_wait_us; /* Queue wait that adds a worker (0=default) */
+	double rate_limit;            /* Rate limit per event type (events/sec, 0=none) */
 	size_t rate_burst;            /* Rate limit burst size */
+	double total_rate_limit;      /* Limit over all events (events/sec, 0=none) */
+	double interface_rate_limit;  /* Limit per interface (events/sec, 0=none) */
+	double genl_family_rate_limit; /* Limit per generic netlink family (0=none) */
+	size_t rate_limit_keys;       /* Keys tracked by per-key limits (0=default) */
 	bool enable_object_pool;      /* Enable event object pooling */
 	size_t object_pool_size;      /* Object pool size */
+	size_t shard_count;           /* Dispatch shards (0=unsharded, see below) */
+	bool work_stealing;           /* Work-stealing thread pool (unsharded only) */
+	size_t dispatch_batch;        /* Events per dispatch task (0=default) */
+	size_t priority_classes;      /* Priority classes (0=none, unsharded only) */
+	struct event_priority_class priority[EVENT_PROCESSOR_MAX_PRIORITIES];
+	enum event_priority_policy priority_policy;
+	unsigned int default_priority; /* Class of events nothing else classifies */
+	enum event_overload_policy overload_policy;
+	unsigned int overload_watermark;  /* Fill percentage shedding starts at (0=75) */
+	unsigned int overload_sample_rate; /* N of 1-in-N overload sampling (0=10) */
+	unsigned int overload_timeout_ms;  /* Longest a blocked producer waits (0=10) */
+	const char *dispatcher_cpus;  /* CPU list of the dispatcher thread (NULL=any) */
+	const char *worker_cpus;      /* CPU list workers or shards are pinned to in turn */
+	const char *thread_name;      /* Thread name prefix (NULL="ep") */
+	unsigned int dispatcher_spin; /* Most idle rounds before the dispatcher parks (0=256) */
+};
+
+/* shard_count value selecting one shard per online CPU */
+#define EVENT_PROCESSOR_SHARDS_PER_CPU ((size_t)-1)
+
+/* Maximum number of dispatch shards */
+#define EVENT_PROCESSOR_MAX_SHARDS 64
+
+/* Per-shard statistics */
+struct event_processor_shard_stats {
+	int cpu;                      /* CPU the shard thread runs on, -1 if unpinned */
+	unsigned long submitted;      /* Events routed to the shard */
+	unsigned long processed;      /* Events handled by the shard thread */
+	unsigned long dropped;        /* Events dropped, shard ring full */
+	size_t queue_size;            /* Events currently queued */
+};
+
+/* Per-priority class statistics */
+struct event_processor_priority_stats {
+	unsigned long submitted;      /* Events queued in the class */
+	unsigned long dispatched;     /* Events taken from the class for handling */
+	unsigned long dropped;        /* Events dropped, class ring full */
+	size_t queue_size;            /* Events currently queued */
+};
+
+/* Overload shedding statistics of one event type */
+struct event_processor_shed_stats {
+	uint32_t event_type;
+	unsigned long dropped;        /* New events refused */
+	unsigned long evicted;        /* Queued events discarded for newer ones */
+	unsigned long sampled;        /* Events skipped by overload sampling */
+	unsigned long blocked;        /* Submissions that waited for room */
+};
+
+/* Dispatcher idle and wakeup statistics */
+struct event_processor_wakeup_stats {
+	unsigned long idle_spins;     /* Idle rounds spent polling before parking */
+	unsigned long parks;          /* Times the dispatcher went to sleep */
+	unsigned long wakeups;        /* Wakeups signalled by producers and workers */
+	unsigned long long parked_ns; /* Time spent parked */
+	unsigned long long wakeup_latency_avg_ns; /* Signal to dispatcher running again */
+	unsigned long long wakeup_latency_max_ns;
+	unsigned int spin_limit;      /* Current adaptive spin budget */
 };
 
 /* Event processor structure (opaque) */
@@ -91,6 +219,44 @@ struct event_processor;
  * event_processor_create() - Create event processor
  * @config: Configuration parameters
  *
+ * With shard_count set, the thread pool and central dispatcher are
+ * replaced by shards: each shard owns a thread, pinned to a CPU where
+ * possible, and one single-producer ring per producer lane. Events are
+ * routed by a hash of their interface name, so events of one interface
+ * from one lane are handled in submission order. Handlers run on the
+ * shard threads; thread_pool_size and work_queue_size are ignored.
+ *
+ * Events are drained from each lane in batches of up to dispatch_batch
+ * (at most EVENT_PROCESSOR_MAX_BATCH), one thread pool task per batch.
+ *
+ * With thread_pool_max set an unsharded, non-work-stealing processor
+ * sizes its pool between thread_pool_min and thread_pool_max by queue
+ * wait, see thread_pool_create_opts(). thread_pool_size is the start.
+ *
+ * With priority_classes set, events are queued by priority class
+ * instead of by lane, each class in a ring of its own capacity. Every
+ * batch is filled from the classes in priority_policy order: strictly
+ * by class, or by weighted rounds so less urgent classes still make
+ * progress under load. Events are classified by the classifier, then
+ * by the event type map, and fall back to default_priority.
+ *
+ * overload_policy decides what happens to events that do not fit.
+ * Drop-oldest evicts from the head of the full ring, except on shard
+ * rings of added lanes, which cannot be shared with their shard thread.
+ * Drop-by-priority needs priority classes: once all classes together
+ * pass overload_watermark, the least urgent class is shed first and
+ * more urgent ones at higher fill levels; class 0 only loses events to
+ * a full ring. Sampling keeps every overload_sample_rate-th event of
+ * each type while the ring is above the watermark. Blocking makes the
+ * producer retry for up to overload_timeout_ms, so it must not be used
+ * from handlers. Evicted and shed events count as dropped.
+ *
+ * Threads are named "<thread_name>-dispatch", "-worker-<n>" and
+ * "-shard-<n>". With worker_cpus set, worker and shard n are pinned to
+ * the n-th listed CPU, and rings and pools are allocated on the NUMA
+ * node of the first listed CPU (of dispatcher_cpus without worker_cpus).
+ * Without worker_cpus, shards are spread over all allowed CPUs.
+ *
  * Returns: Pointer to event processor or NULL on error
  */
 struct event_processor *event_processor_create(struct event_processor_config *config);
@@ -108,27 +274,225 @@ void event_processor_destroy(struct event_processor *ep, bool wait);
  * @handler: Handler function
  * @ctx: Context to pass to handler
  *
+ * Handlers are called from every worker at once, without a lock held,
+ * so they must be thread-safe.
+ *
  * Returns: Handler ID or -1 on error
  */
 int event_processor_register_handler(struct event_processor *ep,
                                      event_handler_t handler, void *ctx);
 
+/**
+ * event_processor_register_batch_handler() - Register batch event handler
+ * @ep: Event processor
+ * @handler: Handler function, called once per dispatched batch
+ * @ctx: Context to pass to handler
+ *
+ * The events are only valid during the call; use nlmon_event_share()
+ * to keep one. Handlers registered either way see every event.
+ *
+ * Returns: Handler ID or -1 on error
+ */
+int event_processor_register_batch_handler(struct event_processor *ep,
+                                           event_batch_handler_t handler, void *ctx);
+
 /**
  * event_processor_unregister_handler() - Unregister event handler
  * @ep: Event processor
  * @handler_id: Handler ID returned by register
+ *
+ * Returns once no worker is still running the handler, so its context
+ * can be freed. Must not be called from a handler.
  */
 void event_processor_unregister_handler(struct event_processor *ep, int handler_id);
 
+/**
+ * nlmon_event_materialize() - Decode deferred netlink attributes
+ * @event: Event
+ *
+ * Producers in lazy decode mode leave netlink.data and interface unset
+ * until first needed. Consumers reading them must call this first; the
+ * pending decode is only valid while the producer's callback runs.
+ *
+ * Returns: 0 on success or if nothing was pending, negative errno on failure
+ */
+int nlmon_event_materialize(struct nlmon_event *event);
+
+/**
+ * nlmon_event_copy_data() - Give an event its own copy of a payload
+ * @event: Event whose data is not owned yet (e.g. a plain struct copy)
+ * @data: Payload to copy (NULL for none)
+ * @size: Payload size
+ *
+ * Payloads of up to NLMON_EVENT_INLINE_DATA bytes are copied to the
+ * event's inline area, larger ones to the heap. netlink.data pointing
+ * at @data is moved to the copy as well.
+ *
+ * Returns: 0 on success, -1 on allocation failure
+ */
+int nlmon_event_copy_data(struct nlmon_event *event, const void *data, size_t size);
+
+/**
+ * nlmon_event_free_data() - Release a payload from nlmon_event_copy_data()
+ * @event: Event
+ */
+void nlmon_event_free_data(struct nlmon_event *event);
+
+/**
+ * nlmon_event_data_stats() - Get payload placement statistics
+ * @inline_hits: Output for payloads placed in the inline area
+ * @spills: Output for payloads too large for it
+ *
+ * Counts payloads copied by nlmon_event_copy_data() and
+ * nlmon_event_alloc() process-wide.
+ */
+void nlmon_event_data_stats(unsigned long *inline_hits, unsigned long *spills);
+
+/**
+ * nlmon_event_alloc() - Allocate a refcounted event
+ * @data_size: Size of the payload (0 for none)
+ *
+ * The event and its payload are a single allocation, payloads that fit
+ * use the inline area. The event is zeroed, data points at the zeroed
+ * payload (NULL if @data_size is 0) and the caller holds the only
+ * reference.
+ *
+ * Returns: Event or NULL on allocation failure
+ */
+struct nlmon_event *nlmon_event_alloc(size_t data_size);
+
+/**
+ * nlmon_event_share() - Get a reference to an event
+ * @event: Event
+ *
+ * Refcounted events just gain a reference. Any other event (e.g. one
+ * on a producer's stack) is materialized and copied once, together
+ * with its data payload, into a new refcounted event. Consumers that
+ * keep an event beyond a handler call use this instead of copying it;
+ * the payload of a refcounted event is owned by the event and must not
+ * be freed or modified.
+ *
+ * Returns: Event reference to release with nlmon_event_put(), or NULL
+ * on allocation failure
+ */
+struct nlmon_event *nlmon_event_share(struct nlmon_event *event);
+
+/**
+ * nlmon_event_put() - Release an event reference
+ * @event: Event reference from nlmon_event_alloc() or nlmon_event_share()
+ *
+ * The event and its payload are freed with the last reference.
+ */
+void nlmon_event_put(struct nlmon_event *event);
+
+/**
+ * nlmon_event_is_shared() - Check whether an event is refcounted
+ * @event: Event
+ *
+ * Plain copies of a refcounted event (e.g. by assignment) are not.
+ *
+ * Returns: true for events from nlmon_event_alloc() or nlmon_event_share()
+ */
+bool nlmon_event_is_shared(const struct nlmon_event *event);
+
+/**
+ * nlmon_event_weight() - Get the sample weight of an event
+ * @event: Event
+ *
+ * Returns: Events @event stands for, 1 unless it was sampled
+ */
+static inline uint32_t nlmon_event_weight(const struct nlmon_event *event)
+{
+	return event->sample_weight ? event->sample_weight : 1;
+}
+
 /**
  * event_processor_submit() - Submit event for processing
  * @ep: Event processor
- * @event: Event to process (will be copied if object pool enabled)
+ * @event: Event to process
+ *
+ * A refcounted event the caller holds the only reference to is queued
+ * by reference, without copying, and the processor assigns its sequence
+ * number in place: submit it before publishing it anywhere else. One
+ * already shared with other holders is never modified, the processor
+ * queues its own copy. Other events are copied, including their data
+ * payload. Either way the caller keeps ownership of @event.
  *
- * Returns: true on success, false if queue full or rate limited
+ * Returns: true on success, false if dropped by the overload policy or
+ * rate limited
  */
 bool event_processor_submit(struct event_processor *ep, struct nlmon_event *event);
 
+/**
+ * event_processor_add_lane() - Add a producer lane
+ * @ep: Event processor
+ * @capacity: Lane ring buffer capacity (0 = ring_buffer_size from config)
+ *
+ * Each lane has its own ring buffer and must only be fed by a single
+ * producer thread. The dispatcher services lanes round-robin, so a burst
+ * on one lane does not queue behind another. Lane 0 always exists, is the
+ * lane used by event_processor_submit() and accepts any number of
+ * producer threads. With priority classes, the events of every lane
+ * are queued by class instead.
+ *
+ * Returns: Lane index or -1 on error
+ */
+int event_processor_add_lane(struct event_processor *ep, size_t capacity);
+
+/**
+ * event_processor_submit_lane() - Submit event through a producer lane
+ * @ep: Event processor
+ * @lane: Lane index returned by event_processor_add_lane()
+ * @event: Event to process, queued as by event_processor_submit()
+ *
+ * Returns: true on success, false if lane invalid, full or rate limited
+ */
+bool event_processor_submit_lane(struct event_processor *ep, int lane,
+                                 struct nlmon_event *event);
+
+/**
+ * event_processor_submit_batch() - Submit an array of events
+ * @ep: Event processor
+ * @lane: Lane index, 0 for the shared lane of event_processor_submit()
+ * @events: Events to process, each queued as by event_processor_submit()
+ * @count: Number of events
+ *
+ * The dispatcher is woken once for the batch rather than per event. The
+ * caller keeps ownership of @events and may reuse the array as soon as
+ * the call returns.
+ *
+ * Returns: Number of events queued, the others were dropped or rate
+ * limited
+ */
+size_t event_processor_submit_batch(struct event_processor *ep, int lane,
+                                    struct nlmon_event *events, size_t count);
+
+/**
+ * event_processor_set_type_priority() - Map an event type to a priority class
+ * @ep: Event processor created with priority classes
+ * @event_type: Event type
+ * @priority: Priority class, below priority_classes
+ *
+ * Returns: true on success, false if invalid or the type map is full
+ */
+bool event_processor_set_type_priority(struct event_processor *ep,
+                                       uint32_t event_type,
+                                       unsigned int priority);
+
+/**
+ * event_processor_set_classifier() - Set the event classifier
+ * @ep: Event processor created with priority classes
+ * @classifier: Classifier, NULL to remove (e.g. one evaluating filters)
+ * @ctx: Context to pass to the classifier
+ *
+ * The classifier runs on the submitting thread, before the type map is
+ * consulted. It must not call back into the event processor.
+ *
+ * Returns: true on success, false if priority classes are disabled
+ */
+bool event_processor_set_classifier(struct event_processor *ep,
+                                    event_classifier_t classifier, void *ctx);
+
 /**
  * event_processor_set_rate_limit() - Set rate limit for event type
  * @ep: Event processor
@@ -142,6 +506,34 @@ bool event_processor_set_rate_limit(struct event_processor *ep,
                                     uint32_t event_type,
                                     double rate, size_t burst);
 
+/**
+ * event_processor_set_key_rate_limit() - Set the rate limit of every key of a class
+ * @ep: Event processor
+ * @key_class: Interface or generic netlink family
+ * @rate: Rate limit (events/sec), 0 to remove the limit
+ * @burst: Burst size
+ *
+ * Each interface or family is limited on its own, before the limit of
+ * the event type. See rate_limiter_map_set_key_limit().
+ *
+ * Returns: true on success, false if rate limiting is disabled
+ */
+bool event_processor_set_key_rate_limit(struct event_processor *ep,
+                                        enum rate_limiter_key_class key_class,
+                                        double rate, size_t burst);
+
+/**
+ * event_processor_rate_limited_keys() - Get the keys rate limited most often
+ * @ep: Event processor
+ * @stats: Output array, may be NULL if @max is 0
+ * @max: Number of entries in @stats
+ *
+ * Returns: Number of entries filled, most denied events first
+ */
+size_t event_processor_rate_limited_keys(struct event_processor *ep,
+                                         struct rate_limiter_key_stats *stats,
+                                         size_t max);
+
 /**
  * event_processor_wait() - Wait for all pending events to complete
  * @ep: Event processor
@@ -166,4 +558,67 @@ void event_processor_stats(struct event_processor *ep,
                           size_t *queue_size,
                           size_t *pool_usage);
 
+/**
+ * event_processor_collect_stats() - Stats bus collector
+ * @snapshot: Snapshot to fill
+ * @ctx: Event processor
+ *
+ * Fills the events and thread pool parts, see stats_bus_add_source().
+ */
+void event_processor_collect_stats(struct nlmon_stats_snapshot *snapshot, void *ctx);
+
+/**
+ * event_processor_shard_stats() - Get per-shard statistics
+ * @ep: Event processor
+ * @stats: Output array, may be NULL if @max is 0
+ * @max: Number of entries in @stats
+ *
+ * The totals reported by event_processor_stats() include all shards.
+ *
+ * Returns: Number of shards (0 if unsharded), at most @max entries filled
+ */
+size_t event_processor_shard_stats(struct event_processor *ep,
+                                   struct event_processor_shard_stats *stats,
+                                   size_t max);
+
+/**
+ * event_processor_priority_stats() - Get per-priority class statistics
+ * @ep: Event processor
+ * @stats: Output array, may be NULL if @max is 0
+ * @max: Number of entries in @stats
+ *
+ * Returns: Number of priority classes (0 if disabled), at most @max
+ * entries filled
+ */
+size_t event_processor_priority_stats(struct event_processor *ep,
+                                      struct event_processor_priority_stats *stats,
+                                      size_t max);
+
+/**
+ * event_processor_wakeup_stats() - Get dispatcher idle and wakeup statistics
+ * @ep: Event processor
+ * @stats: Output statistics
+ *
+ * When its rings run empty the dispatcher spins for an adaptive number of
+ * rounds, then parks on an eventfd. Producers and workers signal it only
+ * while it is parked. Sharded processors have no dispatcher and report
+ * zeros.
+ */
+void event_processor_wakeup_stats(struct event_processor *ep,
+                                  struct event_processor_wakeup_stats *stats);
+
+/**
+ * event_processor_shed_stats() - Get overload shedding statistics per event type
+ * @ep: Event processor
+ * @stats: Output array, may be NULL if @max is 0
+ * @max: Number of entries in @stats
+ *
+ * Only event types with at least one shedding decision are reported.
+ *
+ * Returns: Number of such event types, at most @max entries filled
+ */
+size_t event_processor_shed_stats(struct event_processor *ep,
+                                  struct event_processor_shed_stats *stats,
+                                  size_t max);
+
 #endif /* EVENT_PROCESSOR_H */
@@ -0,0 +1,161 @@
+/* event_sampler.h - Per event type sampling of an event stream
+ *
+ * A sampler decides for each event of a stream whether it is kept and
+ * how many events of the stream it stands for, its sample weight. The
+ * weights of the kept events add up to an unbiased estimate of the
+ * events seen, per event type and overall. Each event type, generic
+ * netlink ones per command, is sampled on its own, in one of three modes:
+ *
+ *   FIXED      every rate-th event, weight rate
+ *   RESERVOIR  rate events picked uniformly out of each interval and
+ *              held until it ends, weight seen / rate
+ *   ADAPTIVE   about rate events per second, each kept with probability
+ *              1 / k and weight k, k following the type's recent rate
+ *
+ * Fractional weights are rounded up or down at random in proportion, so
+ * integer weights stay unbiased. A sampler is not thread safe.
+ */
+
+#ifndef EVENT_SAMPLER_H
+#define EVENT_SAMPLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Forward declaration */
+struct nlmon_event;
+
+/* Event types tracked apart, further types share one state */
+#define EVENT_SAMPLER_MAX_TYPES 256
+
+/* Default interval of reservoirs and rate estimates */
+#define EVENT_SAMPLER_INTERVAL_MS 1000
+
+/* How an event type is sampled */
+enum event_sampler_mode {
+	EVENT_SAMPLER_ALL,              /* Every event, weight 1 */
+	EVENT_SAMPLER_FIXED,            /* 1 in rate */
+	EVENT_SAMPLER_RESERVOIR,        /* rate per interval */
+	EVENT_SAMPLER_ADAPTIVE          /* About rate per second */
+};
+
+/* Sampling of one event type */
+struct event_sampler_rule {
+	uint32_t event_type;
+	bool by_cmd;                    /* Only generic netlink events of genl_cmd */
+	uint8_t genl_cmd;
+	enum event_sampler_mode mode;
+	uint32_t rate;
+};
+
+/* Sampler configuration */
+struct event_sampler_config {
+	const struct event_sampler_rule *rules;
+	size_t num_rules;
+	struct event_sampler_rule fallback;  /* Types without a rule, event_type unused */
+	unsigned int interval_ms;       /* 0 for EVENT_SAMPLER_INTERVAL_MS */
+};
+
+/* Sampler statistics */
+struct event_sampler_stats {
+	uint64_t seen;                  /* Events offered */
+	uint64_t kept;                  /* Events handed on, reservoirs included */
+	uint64_t weight;                /* Sum of their weights */
+	uint64_t held;                  /* Events in reservoirs now */
+	uint64_t overflow;              /* Events of types beyond EVENT_SAMPLER_MAX_TYPES */
+	uint32_t types;                 /* Event types tracked */
+};
+
+/* Called with each event a reservoir hands on, the event is only valid during the call */
+typedef void (*event_sampler_fn)(struct nlmon_event *event, uint32_t weight, void *ctx);
+
+/* Sampler handle (opaque) */
+struct event_sampler;
+
+/**
+ * event_sampler_config_active() - Check whether a configuration samples
+ * @config: Configuration, may be NULL
+ *
+ * Returns: true if some event type is sampled at all
+ */
+bool event_sampler_config_active(const struct event_sampler_config *config);
+
+/**
+ * event_sampler_create() - Create a sampler
+ * @config: Configuration, the rules are copied
+ *
+ * Returns: Sampler or NULL on error, including a rule with rate 0
+ */
+struct event_sampler *event_sampler_create(const struct event_sampler_config *config);
+
+/**
+ * event_sampler_destroy() - Destroy a sampler
+ * @sampler: Sampler
+ *
+ * Events still held are released, event_sampler_drain() first hands them on.
+ */
+void event_sampler_destroy(struct event_sampler *sampler);
+
+/**
+ * event_sampler_offer() - Sample an event
+ * @sampler: Sampler
+ * @event: Event
+ * @now_ns: CLOCK_MONOTONIC nanoseconds
+ * @fn: Called with the reservoir events of intervals that ended
+ * @ctx: Context for @fn
+ *
+ * Intervals that ended are closed first. A reservoir keeps a reference
+ * to @event, from nlmon_event_share(), to hand it to @fn when its
+ * interval ends.
+ *
+ * Returns: Sample weight of @event if kept now, 0 if dropped or held
+ */
+uint32_t event_sampler_offer(struct event_sampler *sampler, struct nlmon_event *event,
+                             uint64_t now_ns, event_sampler_fn fn, void *ctx);
+
+/**
+ * event_sampler_tick() - Close the intervals that ended
+ * @sampler: Sampler
+ * @now_ns: CLOCK_MONOTONIC nanoseconds
+ * @fn: Called with the events of the reservoirs closed, in timestamp order
+ * @ctx: Context for @fn
+ *
+ * Call it every so often while no events come, reservoirs otherwise hold
+ * their events until the next one.
+ *
+ * Returns: Number of events handed to @fn
+ */
+size_t event_sampler_tick(struct event_sampler *sampler, uint64_t now_ns,
+                          event_sampler_fn fn, void *ctx);
+
+/**
+ * event_sampler_drain() - Close every interval now
+ * @sampler: Sampler
+ * @fn: Called with the events held, in timestamp order
+ * @ctx: Context for @fn
+ *
+ * For a flush or shutdown; the weights are those of the part of the
+ * interval that passed.
+ *
+ * Returns: Number of events handed to @fn
+ */
+size_t event_sampler_drain(struct event_sampler *sampler, event_sampler_fn fn, void *ctx);
+
+/**
+ * event_sampler_holds() - Check whether a sampler has reservoirs
+ * @sampler: Sampler
+ *
+ * Returns: true if events may be held, and event_sampler_tick() is needed
+ */
+bool event_sampler_holds(const struct event_sampler *sampler);
+
+/**
+ * event_sampler_get_stats() - Get sampler statistics
+ * @sampler: Sampler
+ * @stats: Output
+ */
+void event_sampler_get_stats(const struct event_sampler *sampler,
+                             struct event_sampler_stats *stats);
+
+#endif /* EVENT_SAMPLER_H */
@@ -0,0 +1,252 @@
+/* event_stream.h - Batched, compressed event streaming to a collector
+ *
+ * A stream exporter packs events into batches of binary records, the
+ * event bus record (struct event_bus_record) behind a struct
+ * binexp_record header, compresses each batch with zlib and sends it to
+ * a collector over TCP or TLS as one length-prefixed frame.
+ *
+ * Flow control: at most a window of batches is in flight, and the
+ * collector acknowledges each batch once it has handed its events on.
+ * Unacknowledged batches are sent again after a reconnect; the collector
+ * drops batches it has seen, so every event arrives once. Batches that
+ * cannot go out are kept in memory up to a limit, then appended to a
+ * spill file, which a restarted exporter sends before anything new.
+ *
+ * Frame headers are little endian. Records keep the byte order of the
+ * sender, which its hello announces and the collector converts from.
+ */
+
+#ifndef EVENT_STREAM_H
+#define EVENT_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "event_bus.h"
+
+/* Forward declaration */
+struct nlmon_event;
+
+#define EVENT_STREAM_MAGIC 0x4e4c5354                   /* "NLST" */
+#define EVENT_STREAM_VERSION 1
+#define EVENT_STREAM_PORT 6515
+#define EVENT_STREAM_NODE_SIZE 64                       /* Node name, NUL included */
+#define EVENT_STREAM_BATCH_EVENTS 512                   /* Events per batch */
+#define EVENT_STREAM_BATCH_BYTES (256 * 1024)           /* Uncompressed bytes per batch */
+#define EVENT_STREAM_BATCH_DELAY_MS 1000                /* Oldest event a batch waits with */
+#define EVENT_STREAM_WINDOW 8                           /* Batches in flight */
+#define EVENT_STREAM_MEMORY_DEFAULT (4 * 1024 * 1024)   /* Queued batch bytes before spilling */
+#define EVENT_STREAM_SPILL_DEFAULT (256 * 1024 * 1024)  /* Spill file bytes */
+#define EVENT_STREAM_MAX_FRAME (16 * 1024 * 1024)       /* Largest payload accepted */
+
+/* Frame types */
+enum event_stream_frame_type {
+	EVENT_STREAM_HELLO = 1,         /* Exporter: struct event_stream_hello */
+	EVENT_STREAM_WELCOME = 2,       /* Collector: seq of the last batch it has */
+	EVENT_STREAM_BATCH = 3,         /* Exporter: compressed records */
+	EVENT_STREAM_ACK = 4,           /* Collector: seq of the batch handed on */
+};
+
+/* Batch payload encodings */
+enum event_stream_codec {
+	EVENT_STREAM_CODEC_NONE = 0,
+	EVENT_STREAM_CODEC_DEFLATE = 1, /* zlib stream */
+};
+
+/* Frame header, little endian, the payload follows */
+struct event_stream_frame {
+	uint32_t magic;                 /* EVENT_STREAM_MAGIC */
+	uint16_t type;                  /* enum event_stream_frame_type */
+	uint16_t codec;                 /* enum event_stream_codec */
+	uint64_t seq;                   /* Batch sequence, increasing across restarts */
+	uint32_t len;                   /* Payload bytes */
+	uint32_t raw_len;               /* Payload bytes once decoded */
+	uint32_t count;                 /* Events in a batch */
+	uint32_t crc;                   /* crc32 of the decoded payload */
+};
+
+/* Hello payload */
+struct event_stream_hello {
+	uint16_t version;               /* EVENT_STREAM_VERSION */
+	uint8_t big_endian;             /* Byte order of the records */
+	uint8_t reserved;
+	uint32_t event_size;            /* sizeof(struct binexp_event) */
+	char node[EVENT_STREAM_NODE_SIZE];
+};
+
+/* Stream exporter configuration, zero fields take the defaults */
+struct event_stream_config {
+	const char *server;             /* Collector hostname or IP */
+	uint16_t port;                  /* EVENT_STREAM_PORT by default */
+	bool tls;                       /* Needs a build with ENABLE_TLS */
+	const char *tls_cert;
+	const char *tls_key;
+	const char *tls_ca;
+	const char *node;               /* Name of this node (NULL for the hostname) */
+	bool include_raw;               /* Append the raw netlink message */
+	int level;                      /* zlib level, 0 for 1 (fastest), -1 to not compress */
+	unsigned int batch_events;
+	size_t batch_bytes;
+	unsigned int batch_delay_ms;
+	unsigned int window;
+	size_t memory_limit;
+	const char *spill_path;         /* NULL to drop what does not fit in memory */
+	size_t spill_limit;
+	uint32_t reconnect_interval;    /* Seconds between attempts, 5 by default */
+	unsigned int ack_timeout_ms;    /* Reconnect when a batch waits longer, 10000 by default */
+};
+
+/* Stream exporter statistics */
+struct event_stream_stats {
+	uint64_t events;                /* Events batched */
+	uint64_t batches;               /* Batches sealed */
+	uint64_t batches_acked;
+	uint64_t bytes_raw;             /* Batch bytes before compression */
+	uint64_t bytes_sent;            /* Frame bytes written, resends included */
+	uint64_t spilled;               /* Batches written to the spill file */
+	uint64_t spill_bytes;           /* Bytes in the spill file now */
+	uint64_t dropped;               /* Events lost to full memory and spill */
+	uint32_t reconnections;
+	bool connected;
+};
+
+/* Stream exporter handle (opaque) */
+struct event_stream;
+
+/**
+ * event_stream_create() - Create a stream exporter
+ * @config: Configuration
+ *
+ * Connects at once, and later again as events come, if the collector is
+ * not reachable yet. Batches left in the spill file are sent first.
+ *
+ * Returns: Stream exporter handle or NULL on error
+ */
+struct event_stream *event_stream_create(const struct event_stream_config *config);
+
+/**
+ * event_stream_destroy() - Send what is possible and destroy the exporter
+ * @stream: Stream exporter handle
+ *
+ * Waits up to the ack timeout for the collector. Batches still not
+ * acknowledged go to the spill file if there is one.
+ */
+void event_stream_destroy(struct event_stream *stream);
+
+/**
+ * event_stream_write_event() - Add an event to the current batch
+ * @stream: Stream exporter handle
+ * @event: Event
+ *
+ * A full batch, or one older than the batch delay, is sealed and sent.
+ *
+ * Returns: true if batched, false on error
+ */
+bool event_stream_write_event(struct event_stream *stream, const struct nlmon_event *event);
+
+/**
+ * event_stream_flush() - Seal the current batch and send what the window allows
+ * @stream: Stream exporter handle
+ *
+ * Returns: true if nothing is left unsent, false otherwise
+ */
+bool event_stream_flush(struct event_stream *stream);
+
+/**
+ * event_stream_get_stats() - Get exporter statistics
+ * @stream: Stream exporter handle
+ * @stats: Output
+ */
+void event_stream_get_stats(struct event_stream *stream, struct event_stream_stats *stats);
+
+/**
+ * typedef event_collector_fn - Receiver of collected events
+ * @node: Node that sent the event
+ * @record: Record in host byte order, its raw message follows
+ * @ctx: Collector context
+ *
+ * Called on a collector worker, in the order each node sent them. With
+ * several workers, events of different nodes come in concurrently.
+ */
+typedef void (*event_collector_fn)(const char *node, const struct event_bus_record *record,
+                                   void *ctx);
+
+/**
+ * typedef event_collector_batch_fn - Receiver of collected batches
+ * @node: Node that sent the batch
+ * @records: Records in host byte order, valid until the call returns
+ * @count: Number of records
+ * @ctx: Collector context
+ *
+ * Like event_collector_fn, a batch of one node at a time. The batch is
+ * acknowledged once this returns, so blocking here holds the node back.
+ */
+typedef void (*event_collector_batch_fn)(const char *node,
+                                         const struct event_bus_record *const *records,
+                                         size_t count, void *ctx);
+
+/* Collector configuration */
+struct event_collector_config {
+	const char *bind_addr;          /* NULL for any */
+	uint16_t port;                  /* 0 for EVENT_STREAM_PORT */
+	bool any_port;                  /* Let the kernel pick the port, see event_collector_port() */
+	bool tls;                       /* Needs a build with ENABLE_TLS */
+	const char *tls_cert;
+	const char *tls_key;
+	unsigned int max_clients;       /* 1024 by default */
+	unsigned int workers;           /* Threads serving connections, 1 by default */
+	event_collector_fn fn;
+	event_collector_batch_fn batch_fn;  /* Used instead of fn if set */
+	void *ctx;
+};
+
+/* Collector statistics */
+struct event_collector_stats {
+	uint64_t connections;           /* Connections accepted */
+	uint64_t batches;               /* Batches handed on */
+	uint64_t duplicates;            /* Batches received again and dropped */
+	uint64_t events;
+	uint64_t bytes_in;              /* Frame bytes read */
+	uint64_t bytes_raw;             /* Batch bytes once decoded */
+	uint64_t errors;                /* Connections closed on a malformed frame */
+	uint32_t nodes;                 /* Distinct nodes seen */
+	uint32_t clients;               /* Connections open now */
+};
+
+/* Collector handle (opaque) */
+struct event_collector;
+
+/**
+ * event_collector_create() - Listen for stream exporters
+ * @config: Configuration
+ *
+ * Connections are spread over the worker threads, which decode the
+ * batches of their connections in parallel.
+ *
+ * Returns: Collector handle or NULL on error
+ */
+struct event_collector *event_collector_create(const struct event_collector_config *config);
+
+/**
+ * event_collector_destroy() - Close every connection and stop
+ * @collector: Collector handle
+ */
+void event_collector_destroy(struct event_collector *collector);
+
+/**
+ * event_collector_port() - Port the collector listens on
+ * @collector: Collector handle
+ *
+ * Returns: Port in host byte order
+ */
+uint16_t event_collector_port(const struct event_collector *collector);
+
+/**
+ * event_collector_get_stats() - Get collector statistics
+ * @collector: Collector handle
+ * @stats: Output
+ */
+void event_collector_get_stats(struct event_collector *collector,
+                               struct event_collector_stats *stats);
+
+#endif /* EVENT_STREAM_H */
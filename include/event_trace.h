@@ -0,0 +1,137 @@
+/* event_trace.h - Per-event latency tracing through the pipeline
+ *
+ * A traced event carries a compact record of when it reached each stage,
+ * as nanosecond offsets from its receipt on the CLOCK_MONOTONIC clock.
+ * Producers begin the trace, each stage stamps it, and the record goes
+ * to the sink installed with nlmon_trace_set_sink() when the event has
+ * been handled. Stages that run later on a copy of the event, such as
+ * export workers, report themselves separately.
+ *
+ * Events are only traced while a sink is installed; otherwise beginning
+ * a trace marks it untraced and stamping it costs a single branch.
+ */
+
+#ifndef EVENT_TRACE_H
+#define EVENT_TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "nlmon_clock.h"
+
+/* Pipeline stages in the order events reach them */
+enum nlmon_trace_stage {
+	NLMON_TRACE_RECV,       /* Message taken from the socket */
+	NLMON_TRACE_PARSE,      /* Message decoded into an event */
+	NLMON_TRACE_SUBMIT,     /* Queued on the event processor */
+	NLMON_TRACE_DISPATCH,   /* Taken off the queue for handlers */
+	NLMON_TRACE_FILTER,     /* Passed the filters */
+	NLMON_TRACE_HANDLER,    /* Handlers done */
+	NLMON_TRACE_STORAGE,    /* Committed to storage */
+	NLMON_TRACE_EXPORT,     /* Written by an exporter */
+	NLMON_TRACE_STAGES
+};
+
+/* Trace flags */
+#define NLMON_TRACE_SAMPLED (1U << 0)   /* Kept in full by the sink */
+
+/**
+ * struct nlmon_event_trace - Stage timestamps of one event
+ * @recv_ns: Receipt on CLOCK_MONOTONIC, 0 if the event is not traced
+ * @offset_ns: Nanoseconds from @recv_ns to each stage, 0 until reached,
+ *             saturating at UINT32_MAX
+ * @id: Trace id
+ * @flags: NLMON_TRACE_* flags
+ */
+struct nlmon_event_trace {
+	uint64_t recv_ns;
+	uint32_t offset_ns[NLMON_TRACE_STAGES];
+	uint32_t id;
+	uint8_t flags;
+};
+
+/**
+ * typedef nlmon_trace_sink_fn - Receiver of finished traces
+ * @trace: Trace record
+ * @stage: Stage reported, or NLMON_TRACE_STAGES for every stage reached
+ * @ctx: Sink context
+ *
+ * Called on the thread that finished the stage.
+ */
+typedef void (*nlmon_trace_sink_fn)(const struct nlmon_event_trace *trace,
+                                    enum nlmon_trace_stage stage, void *ctx);
+
+/**
+ * nlmon_trace_set_sink() - Install the receiver of traces
+ * @fn: Sink, NULL stops tracing
+ * @ctx: Passed to @fn
+ * @sample_rate: Mark 1 in @sample_rate traces NLMON_TRACE_SAMPLED, 0 for none
+ *
+ * Events in flight may still report to a sink that was replaced, so it
+ * must stay valid until the pipeline has drained.
+ */
+void nlmon_trace_set_sink(nlmon_trace_sink_fn fn, void *ctx, unsigned int sample_rate);
+
+/**
+ * nlmon_trace_enabled() - Whether events are being traced
+ *
+ * Returns: true while a sink is installed
+ */
+bool nlmon_trace_enabled(void);
+
+/**
+ * nlmon_trace_begin() - Start the trace of an event
+ * @trace: Trace record of the event
+ * @recv_ns: When its message was received, 0 for now
+ *
+ * Only marks the record untraced when tracing is off.
+ */
+void nlmon_trace_begin(struct nlmon_event_trace *trace, uint64_t recv_ns);
+
+/**
+ * nlmon_trace_finish() - Stamp the last stage and hand the trace to the sink
+ * @trace: Trace record of the event
+ * @stage: Stage just reached
+ *
+ * Reports every stage reached, then empties the record so that it is
+ * reported only once.
+ */
+void nlmon_trace_finish(struct nlmon_event_trace *trace, enum nlmon_trace_stage stage);
+
+/**
+ * nlmon_trace_report() - Stamp a stage and report only that stage
+ * @trace: Trace record, usually of a copy of the event
+ * @stage: Stage just reached
+ */
+void nlmon_trace_report(struct nlmon_event_trace *trace, enum nlmon_trace_stage stage);
+
+/**
+ * nlmon_trace_stage_name() - Name of a stage
+ * @stage: Stage
+ *
+ * Returns: Static string
+ */
+const char *nlmon_trace_stage_name(enum nlmon_trace_stage stage);
+
+static inline uint64_t nlmon_trace_now(void)
+{
+	return nlmon_clock_precise_ns();
+}
+
+/* Record that a traced event reached a stage */
+static inline void nlmon_trace_stamp(struct nlmon_event_trace *trace,
+                                     enum nlmon_trace_stage stage)
+{
+	uint64_t offset;
+	
+	if (!trace->recv_ns)
+		return;
+	
+	offset = nlmon_trace_now() - trace->recv_ns;
+	
+	/* 0 means not reached, so reached at once becomes 1 */
+	trace->offset_ns[stage] = offset == 0 ? 1 : offset > UINT32_MAX ? UINT32_MAX :
+	                          (uint32_t)offset;
+}
+
+#endif /* EVENT_TRACE_H */
@@ -1,7 +1,13 @@
 /* export_layer.h - Unified export layer interface
  *
  * Provides a unified interface to all export modules including
- * PCAP, JSON, Prometheus metrics, syslog, and log rotation.
+ * PCAP, JSON, binary, Prometheus metrics, OTLP, syslog, and log rotation.
+ *
+ * Events handed to export_layer_export_event() are queued for each
+ * enabled exporter, in a bounded queue drained by a worker thread of its
+ * own, so a slow disk or syslog peer only delays its own exporter.
+ * Each exporter may sample the events it takes by event type, the
+ * records it writes then carry their sample weight.
  */
 
 #ifndef EXPORT_LAYER_H
@@ -9,9 +15,58 @@
 
 #include "pcap_export.h"
 #include "json_export.h"
+#include "binary_export.h"
+#include "event_bus.h"
+#include "event_stream.h"
+#include "otlp_export.h"
 #include "prometheus_exporter.h"
 #include "syslog_forwarder.h"
 #include "log_rotation.h"
+#include "event_sampler.h"
+
+/* Forward declaration */
+struct nlmon_event;
+struct nlmon_stats_snapshot;
+
+/* Export targets, each with a queue and worker of its own */
+enum export_target {
+	EXPORT_TARGET_PCAP,
+	EXPORT_TARGET_JSON,
+	EXPORT_TARGET_PROMETHEUS,
+	EXPORT_TARGET_SYSLOG,
+	EXPORT_TARGET_LOG,
+	EXPORT_TARGET_BINARY,
+	EXPORT_TARGET_BUS,
+	EXPORT_TARGET_STREAM,
+	EXPORT_TARGET_OTLP,
+	EXPORT_TARGET_COUNT
+};
+
+/* What a full export queue does with a new event */
+enum export_overflow {
+	EXPORT_OVERFLOW_DROP_NEWEST,    /* Refuse the new event */
+	EXPORT_OVERFLOW_DROP_OLDEST,    /* Drop the oldest queued event to make room */
+	EXPORT_OVERFLOW_BLOCK           /* Wait for room */
+};
+
+/* Export queue configuration, zero fields take the defaults */
+struct export_queue_config {
+	size_t size;                    /* Events queued */
+	enum export_overflow overflow;
+};
+
+/* Export queue statistics */
+struct export_queue_stats {
+	uint64_t queued;                /* Events accepted into the queue */
+	uint64_t exported;              /* Events the exporter took */
+	uint64_t failed;                /* Events the exporter failed on */
+	uint64_t dropped;               /* Events lost to overflow */
+	uint64_t sampled;               /* Events left out by sampling */
+	uint64_t held;                  /* Events held by sampling reservoirs */
+	size_t queue_depth;             /* Events queued now */
+	uint64_t lag_us;                /* Time the oldest queued event has waited */
+	uint64_t lag_max_us;            /* Longest time from queueing to export */
+};
 
 /* Export layer configuration */
 struct export_layer_config {
@@ -19,6 +74,7 @@ struct export_layer_config {
 	bool enable_pcap;
 	const char *pcap_filename;
 	struct pcap_rotation_policy pcap_policy;
+	struct pcap_export_options pcap_options;  /* Format, buffering, O_DIRECT */
 	
 	/* JSON export */
 	bool enable_json;
@@ -26,11 +82,34 @@ struct export_layer_config {
 	enum json_format json_format;
 	bool json_streaming;
 	struct json_rotation_policy json_policy;
+	struct io_service *json_io;     /* Write service for the JSON file (NULL=caller) */
+	
+	/* Binary export, see binary_export.h */
+	bool enable_binary;
+	const char *binary_filename;
+	struct binary_export_options binary_options;
+	
+	/* Shared memory event bus, see event_bus.h */
+	bool enable_bus;
+	const char *bus_name;           /* NULL for EVENT_BUS_DEFAULT_NAME */
+	struct event_bus_options bus_options;
+	
+	/* Remote collector stream, see event_stream.h */
+	bool enable_stream;
+	struct event_stream_config stream_config;
+	
+	/* OpenTelemetry collector, see otlp_export.h; metrics default to the
+	 * layer's Prometheus exporter */
+	bool enable_otlp;
+	struct otlp_config otlp_config;
 	
 	/* Prometheus metrics */
 	bool enable_prometheus;
 	uint16_t prometheus_port;
 	const char *prometheus_path;
+	const char *prometheus_cpus;    /* CPU list of the HTTP thread (NULL=any) */
+	unsigned int prometheus_cache_ms;  /* Scrape response reuse, 0 for default */
+	struct cardinality_limits prometheus_cardinality;  /* Default series limits per name */
 	
 	/* Syslog forwarding */
 	bool enable_syslog;
@@ -40,6 +119,13 @@ struct export_layer_config {
 	bool enable_log_rotation;
 	const char *log_filename;
 	struct log_rotation_policy log_policy;
+	
+	/* Event queues, indexed by enum export_target */
+	bool sync_export;               /* Export on the caller's thread, without queues */
+	struct export_queue_config queues[EXPORT_TARGET_COUNT];
+	
+	/* Sampling of the events each exporter takes, see event_sampler.h */
+	struct event_sampler_config sampling[EXPORT_TARGET_COUNT];
 };
 
 /* Export layer handle (opaque) */
@@ -75,6 +161,38 @@ struct pcap_exporter *export_layer_get_pcap(struct export_layer *layer);
  */
 struct json_exporter *export_layer_get_json(struct export_layer *layer);
 
+/**
+ * export_layer_get_binary() - Get binary exporter handle
+ * @layer: Export layer handle
+ *
+ * Returns: Binary exporter handle or NULL if not enabled
+ */
+struct binary_exporter *export_layer_get_binary(struct export_layer *layer);
+
+/**
+ * export_layer_get_bus() - Get event bus publisher handle
+ * @layer: Export layer handle
+ *
+ * Returns: Event bus handle or NULL if not enabled
+ */
+struct event_bus *export_layer_get_bus(struct export_layer *layer);
+
+/**
+ * export_layer_get_stream() - Get stream exporter handle
+ * @layer: Export layer handle
+ *
+ * Returns: Stream exporter handle or NULL if not enabled
+ */
+struct event_stream *export_layer_get_stream(struct export_layer *layer);
+
+/**
+ * export_layer_get_otlp() - Get OTLP exporter handle
+ * @layer: Export layer handle
+ *
+ * Returns: OTLP exporter handle or NULL if not enabled
+ */
+struct otlp_exporter *export_layer_get_otlp(struct export_layer *layer);
+
 /**
  * export_layer_get_prometheus() - Get Prometheus exporter handle
  * @layer: Export layer handle
@@ -99,12 +217,50 @@ struct syslog_forwarder *export_layer_get_syslog(struct export_layer *layer);
  */
 struct log_rotator *export_layer_get_log_rotator(struct export_layer *layer);
 
+/**
+ * export_layer_export_event() - Hand an event to all enabled exporters
+ * @layer: Export layer handle
+ * @event: Event to export
+ *
+ * Queues a reference to @event for each exporter; the caller keeps its
+ * own. Safe to call from several threads. With sync_export the
+ * exporters run on the calling thread instead, which must then be the
+ * only one calling.
+ *
+ * Returns: true if every exporter took the event, false if one refused
+ * it (queue full) or failed
+ */
+bool export_layer_export_event(struct export_layer *layer, struct nlmon_event *event);
+
 /**
  * export_layer_flush_all() - Flush all exporters
  * @layer: Export layer handle
  *
+ * A barrier: waits until every exporter has exported the events queued
+ * before the call, then flushed its output.
+ *
  * Returns: true on success, false on error
  */
 bool export_layer_flush_all(struct export_layer *layer);
 
+/**
+ * export_layer_get_queue_stats() - Get export queue statistics
+ * @layer: Export layer handle
+ * @target: Exporter
+ * @stats: Output for statistics
+ *
+ * Returns: true on success, false if @target is not enabled or has no queue
+ */
+bool export_layer_get_queue_stats(struct export_layer *layer, enum export_target target,
+                                  struct export_queue_stats *stats);
+
+/**
+ * export_layer_collect_stats() - Stats bus collector
+ * @snapshot: Snapshot to fill
+ * @ctx: Export layer
+ *
+ * Fills the export queue part, see stats_bus_add_source().
+ */
+void export_layer_collect_stats(struct nlmon_stats_snapshot *snapshot, void *ctx);
+
 #endif /* EXPORT_LAYER_H */
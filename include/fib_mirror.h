@@ -0,0 +1,180 @@
+/* fib_mirror.h - In-memory mirror of the kernel routing tables
+ *
+ * Keeps every route seen in route events in a path-compressed binary trie
+ * per routing table and address family, so the longest match of an
+ * address, the routes covering a prefix and the routes inside a prefix
+ * are found in time bound by the prefix length rather than the number of
+ * routes, and without a dump from the kernel.
+ *
+ * Nodes and routes live in two arrays indexed by 32-bit numbers instead
+ * of separate allocations, a full BGP table of a million routes takes
+ * around 100 MB. Routes of one prefix that differ in TOS or priority are
+ * kept side by side, as the kernel does.
+ *
+ * All functions are safe from any number of threads.
+ */
+
+#ifndef FIB_MIRROR_H
+#define FIB_MIRROR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+/* Forward declarations */
+struct nlmon_route_info;
+
+/* Route of the mirror */
+struct fib_mirror_route {
+	int family;                      /* AF_INET or AF_INET6 */
+	unsigned int table;              /* Routing table */
+	unsigned char dst_len;           /* Destination prefix length */
+	unsigned char tos;               /* Type of service */
+	unsigned char protocol;          /* Routing protocol */
+	unsigned char scope;             /* Route scope */
+	unsigned char type;              /* Route type */
+	char dst[64];                    /* Destination prefix */
+	char gateway[64];                /* Gateway, empty if none */
+	int oif;                         /* Output interface */
+	unsigned int priority;           /* Route priority */
+	time_t since;                    /* When the route was last added or changed */
+};
+
+/* Called for each route of a walk, return false to stop */
+typedef bool (*fib_mirror_walk_fn)(const struct fib_mirror_route *route, void *ctx);
+
+/* Mirror (opaque) */
+struct fib_mirror;
+
+/**
+ * fib_mirror_create() - Create an empty mirror
+ * @max_routes: Most routes kept, 0 for no limit
+ *
+ * Returns: Mirror or NULL on error
+ */
+struct fib_mirror *fib_mirror_create(size_t max_routes);
+
+/**
+ * fib_mirror_destroy() - Destroy a mirror
+ * @fib: Mirror
+ */
+void fib_mirror_destroy(struct fib_mirror *fib);
+
+/**
+ * fib_mirror_add() - Add or replace a route from a RTM_NEWROUTE event
+ * @fib: Mirror
+ * @route: Parsed route
+ * @now: Timestamp of the event
+ *
+ * A route of the same table, prefix, TOS and priority is replaced, its
+ * timestamp only moves when its next hop or type changed.
+ *
+ * Returns: 0 if added, 1 if replaced, -EINVAL for routes that are not IPv4
+ * or IPv6, -ENOSPC at the route limit, -ENOMEM
+ */
+int fib_mirror_add(struct fib_mirror *fib, const struct nlmon_route_info *route, time_t now);
+
+/**
+ * fib_mirror_delete() - Remove a route of a RTM_DELROUTE event
+ * @fib: Mirror
+ * @route: Parsed route
+ *
+ * Returns: 0 if removed, -ENOENT if not in the mirror, -EINVAL
+ */
+int fib_mirror_delete(struct fib_mirror *fib, const struct nlmon_route_info *route);
+
+/**
+ * fib_mirror_find() - Look up the route a route event refers to
+ * @fib: Mirror
+ * @route: Parsed route, matched on table, prefix, TOS and priority
+ * @out: Output for the route
+ *
+ * Returns: true if found
+ */
+bool fib_mirror_find(struct fib_mirror *fib, const struct nlmon_route_info *route,
+                     struct fib_mirror_route *out);
+
+/**
+ * fib_mirror_covering() - Find the most specific route covering a prefix
+ * @fib: Mirror
+ * @route: Parsed route
+ * @out: Output for the route
+ *
+ * Only routes of the same table with a strictly shorter prefix count, of
+ * several on that prefix the one of the lowest priority.
+ *
+ * Returns: true if found
+ */
+bool fib_mirror_covering(struct fib_mirror *fib, const struct nlmon_route_info *route,
+                         struct fib_mirror_route *out);
+
+/**
+ * fib_mirror_lookup() - Longest prefix match of an address
+ * @fib: Mirror
+ * @table: Routing table
+ * @addr: IPv4 or IPv6 address
+ * @out: Output for the route, of several the one of the lowest priority
+ *
+ * Returns: true if a route matches
+ */
+bool fib_mirror_lookup(struct fib_mirror *fib, unsigned int table, const char *addr,
+                       struct fib_mirror_route *out);
+
+/**
+ * fib_mirror_walk() - Visit the routes inside a prefix
+ * @fib: Mirror
+ * @table: Routing table
+ * @family: AF_INET or AF_INET6
+ * @prefix: Prefix address, NULL for every route of the table and family
+ * @prefix_len: Prefix length
+ * @fn: Called for each route, in address order
+ * @ctx: Passed to @fn
+ *
+ * The mirror is read locked during the walk, @fn must not modify it.
+ *
+ * Returns: Number of routes visited, -EINVAL for an invalid prefix
+ */
+long fib_mirror_walk(struct fib_mirror *fib, unsigned int table, int family,
+                     const char *prefix, unsigned int prefix_len,
+                     fib_mirror_walk_fn fn, void *ctx);
+
+/**
+ * fib_mirror_walk_all() - Visit every route
+ * @fib: Mirror
+ * @fn: Called for each route, in address order within a table and family
+ * @ctx: Passed to @fn
+ *
+ * Read locked as fib_mirror_walk().
+ *
+ * Returns: Number of routes visited, -EINVAL
+ */
+long fib_mirror_walk_all(struct fib_mirror *fib, fib_mirror_walk_fn fn, void *ctx);
+
+/**
+ * fib_mirror_restore() - Put back a route of a walk
+ * @fib: Mirror
+ * @route: Route as walked, its timestamp included
+ *
+ * Restores a mirror saved by a previous process.
+ *
+ * Returns: As fib_mirror_add()
+ */
+int fib_mirror_restore(struct fib_mirror *fib, const struct fib_mirror_route *route);
+
+/**
+ * fib_mirror_clear() - Remove every route
+ * @fib: Mirror
+ */
+void fib_mirror_clear(struct fib_mirror *fib);
+
+/**
+ * fib_mirror_stats() - Get mirror statistics
+ * @fib: Mirror
+ * @routes: Output for the number of routes
+ * @nodes: Output for the number of trie nodes
+ * @bytes: Output for the memory held by nodes and routes
+ */
+void fib_mirror_stats(struct fib_mirror *fib, size_t *routes, size_t *nodes, size_t *bytes);
+
+#endif /* FIB_MIRROR_H */
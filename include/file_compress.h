@@ -0,0 +1,87 @@
+/* file_compress.h - Background gzip compression of rotated files
+ *
+ * Exporters hand each file they rotate out to a compressor, which gzips
+ * it on its own threads with zlib and replaces it with a .gz file. The
+ * exporter never forks a shell or waits for the compression, except
+ * when it rotates again before the last file is done.
+ *
+ * A file is cut into chunks that the threads deflate in parallel into
+ * separate gzip members; gzip and zcat read the concatenation as one
+ * stream.
+ */
+
+#ifndef FILE_COMPRESS_H
+#define FILE_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Default bytes of input per gzip member */
+#define FILE_COMPRESS_CHUNK_SIZE (1024 * 1024)
+
+/* File compressor configuration */
+struct file_compress_config {
+	int level;                  /* zlib level 1-9, 0 for the default (6) */
+	int threads;                /* Compression threads, 0 for one */
+	size_t chunk_size;          /* Input bytes per member, 0 for default */
+};
+
+/* File compressor statistics */
+struct file_compress_stats {
+	uint64_t files;             /* Files compressed */
+	uint64_t failed;            /* Files left uncompressed after an error */
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t pending;           /* Files queued or being compressed */
+};
+
+/* File compressor handle (opaque) */
+struct file_compressor;
+
+/**
+ * file_compressor_create() - Start compression threads
+ * @config: Configuration (NULL for defaults)
+ *
+ * Returns: File compressor handle or NULL on error
+ */
+struct file_compressor *file_compressor_create(const struct file_compress_config *config);
+
+/**
+ * file_compressor_destroy() - Finish queued files and stop the threads
+ * @fc: File compressor (can be NULL)
+ */
+void file_compressor_destroy(struct file_compressor *fc);
+
+/**
+ * file_compressor_submit() - Queue a file for compression
+ * @fc: File compressor
+ * @path: File to compress
+ *
+ * @path is written to @path.gz, through a temporary name, and removed
+ * once the .gz file is complete. On error @path is left as it is.
+ *
+ * Returns: true if queued, false on error
+ */
+bool file_compressor_submit(struct file_compressor *fc, const char *path);
+
+/**
+ * file_compressor_wait() - Wait until every queued file is done
+ * @fc: File compressor
+ *
+ * Called before rotated files are renamed, so no file is renamed
+ * while it is being compressed.
+ */
+void file_compressor_wait(struct file_compressor *fc);
+
+/**
+ * file_compressor_get_stats() - Get compressor statistics
+ * @fc: File compressor
+ * @stats: Output statistics
+ *
+ * Returns: true on success, false on error
+ */
+bool file_compressor_get_stats(struct file_compressor *fc,
+                               struct file_compress_stats *stats);
+
+#endif /* FILE_COMPRESS_H */
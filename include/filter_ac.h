@@ -0,0 +1,78 @@
+/* filter_ac.h - Multi-pattern substring matching for filters
+ *
+ * A regex without operators only tests for a substring. Such patterns
+ * are matched without POSIX regex: one at a time with a plain substring
+ * search, or all the patterns on one field in a single pass through an
+ * Aho-Corasick automaton.
+ */
+
+#ifndef FILTER_AC_H
+#define FILTER_AC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct filter_ac;
+
+/* Called for each pattern found, possibly more than once per pattern */
+typedef void (*filter_ac_hit_fn)(uint32_t id, void *arg);
+
+/**
+ * filter_ac_literal() - Get the substring an extended regex tests for
+ * @pattern: Regex
+ * @len: Length of @pattern
+ * @out: Output for the substring, at least @len bytes
+ * @out_len: Output for the length of the substring
+ *
+ * Backslash escaped punctuation counts as a literal character.
+ *
+ * Returns: true if @pattern is non-empty and has no regex operators
+ */
+bool filter_ac_literal(const char *pattern, size_t len, char *out, size_t *out_len);
+
+/**
+ * filter_ac_create() - Create an empty automaton
+ *
+ * Returns: Pointer to automaton or NULL on error
+ */
+struct filter_ac *filter_ac_create(void);
+
+/**
+ * filter_ac_destroy() - Destroy an automaton
+ * @ac: Automaton
+ */
+void filter_ac_destroy(struct filter_ac *ac);
+
+/**
+ * filter_ac_add() - Add a pattern
+ * @ac: Automaton
+ * @pattern: Non-empty substring to find
+ * @len: Length of @pattern
+ *
+ * Takes effect with the next filter_ac_build().
+ *
+ * Returns: Pattern id, the same for equal patterns, or -1 on error
+ */
+int filter_ac_add(struct filter_ac *ac, const char *pattern, size_t len);
+
+/**
+ * filter_ac_build() - Build the automaton from all patterns added
+ * @ac: Automaton
+ *
+ * Returns: true on success, false on allocation failure
+ */
+bool filter_ac_build(struct filter_ac *ac);
+
+/**
+ * filter_ac_scan() - Find all patterns in a text
+ * @ac: Built automaton
+ * @text: Text to scan
+ * @len: Length of @text
+ * @hit: Called with the id of each pattern found
+ * @arg: Passed to @hit
+ */
+void filter_ac_scan(const struct filter_ac *ac, const char *text, size_t len,
+                    filter_ac_hit_fn hit, void *arg);
+
+#endif /* FILTER_AC_H */
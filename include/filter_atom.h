@@ -0,0 +1,92 @@
+/* filter_atom.h - Interned strings for filter evaluation
+ *
+ * The filter compiler interns every string constant into one process
+ * wide atom table, so string equality at evaluation time becomes an
+ * integer compare. Atoms are never removed; the table only holds the
+ * distinct constants of all filters ever compiled.
+ */
+
+#ifndef FILTER_ATOM_H
+#define FILTER_ATOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* String was not looked up, compare its bytes */
+#define FILTER_ATOM_NONE 0
+
+/* String was looked up and is not interned, so it equals no constant */
+#define FILTER_ATOM_ABSENT UINT32_MAX
+
+/* Set of atoms, built from an IN list of string constants */
+struct filter_atom_set {
+	uint32_t *slots;                /* Open addressing, FILTER_ATOM_NONE if empty */
+	uint32_t mask;                  /* Slot count - 1 */
+	uint32_t count;                 /* Atoms in the set */
+};
+
+/**
+ * filter_atom_intern() - Intern a string
+ * @str: String, need not be NUL terminated
+ * @len: Length of @str
+ *
+ * Returns: Atom of @str, or FILTER_ATOM_NONE on allocation failure
+ */
+uint32_t filter_atom_intern(const char *str, size_t len);
+
+/**
+ * filter_atom_lookup() - Look up the atom of a string without interning it
+ * @str: String, need not be NUL terminated
+ * @len: Length of @str
+ *
+ * Lock free, safe against concurrent filter_atom_intern().
+ *
+ * Returns: Atom of @str, or FILTER_ATOM_ABSENT if it was never interned
+ */
+uint32_t filter_atom_lookup(const char *str, size_t len);
+
+/**
+ * filter_atom_generation() - Get the atom table generation
+ *
+ * Changes whenever a string is interned, so a cached FILTER_ATOM_ABSENT
+ * is only valid while the generation is unchanged.
+ *
+ * Returns: Current generation
+ */
+uint32_t filter_atom_generation(void);
+
+/**
+ * filter_atom_cleanup() - Free the atom table
+ *
+ * Only for process teardown, no compiled filter may be used afterwards.
+ */
+void filter_atom_cleanup(void);
+
+/**
+ * filter_atom_set_init() - Build an atom set
+ * @set: Set to initialize
+ * @atoms: Atoms, duplicates are allowed
+ * @count: Number of entries in @atoms
+ *
+ * Returns: true on success, false on allocation failure
+ */
+bool filter_atom_set_init(struct filter_atom_set *set, const uint32_t *atoms,
+                          size_t count);
+
+/**
+ * filter_atom_set_contains() - Check set membership
+ * @set: Set
+ * @atom: Atom, FILTER_ATOM_NONE and FILTER_ATOM_ABSENT are never members
+ *
+ * Returns: true if @atom is in @set
+ */
+bool filter_atom_set_contains(const struct filter_atom_set *set, uint32_t atom);
+
+/**
+ * filter_atom_set_free() - Free an atom set
+ * @set: Set
+ */
+void filter_atom_set_free(struct filter_atom_set *set);
+
+#endif /* FILTER_ATOM_H */
@@ -0,0 +1,84 @@
+/* filter_cache.h - Compiled filters shared by expression
+ *
+ * Filters submitted through the API, WebSocket subscriptions, hook and
+ * alert conditions and plugin interests often repeat one expression. The
+ * cache maps each expression to one optimized bytecode, so a repeat skips
+ * parsing and compiling and shares the program instead of holding a copy.
+ *
+ * Expressions are looked up by their text with whitespace outside string
+ * literals collapsed, which skips the parser, and on a miss by a canonical
+ * form of their AST. That form puts the field first in a comparison, sorts
+ * IN lists, and sorts the operands of AND and OR chains in front of the
+ * first one reading a field events may not carry, as reordering those
+ * never changes a result (see filter_profile.h). Equivalent expressions
+ * written differently so share one program.
+ *
+ * The cache is process wide and safe from any number of threads.
+ * Bytecode it returns is shared, reference counted and must not be
+ * modified, in particular not by filter_bytecode_optimize().
+ */
+
+#ifndef FILTER_CACHE_H
+#define FILTER_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Forward declarations */
+struct filter_expr;
+struct filter_bytecode;
+struct filter_parse_error;
+
+/* Programs the cache keeps, the least recently used one is dropped past it */
+#define FILTER_CACHE_MAX 1024
+
+/* Texts remembered per program, later spellings go through the parser */
+#define FILTER_CACHE_ALIASES 8
+
+/* Cache statistics */
+struct filter_cache_stats {
+	size_t entries;                 /* Programs held */
+	size_t aliases;                 /* Texts leading to them */
+	uint64_t hits;                  /* Found by text, not parsed */
+	uint64_t canonical_hits;        /* Parsed, found by canonical form */
+	uint64_t misses;                /* Compiled */
+	uint64_t evictions;
+};
+
+/**
+ * filter_cache_get() - Get the shared bytecode of an expression
+ * @expression: Filter expression
+ * @error: Output for the parse error of an invalid expression (can be NULL)
+ *
+ * Invalid expressions are not cached.
+ *
+ * Returns: Reference to optimized bytecode, release it with
+ * filter_bytecode_free(); NULL if @expression does not parse or compile
+ */
+struct filter_bytecode *filter_cache_get(const char *expression,
+                                         struct filter_parse_error *error);
+
+/**
+ * filter_cache_get_expr() - Get the shared bytecode of a parsed expression
+ * @expr: Valid parsed expression, for callers that need the AST too
+ *
+ * Returns: Reference to optimized bytecode, release it with
+ * filter_bytecode_free(); NULL on error
+ */
+struct filter_bytecode *filter_cache_get_expr(const struct filter_expr *expr);
+
+/**
+ * filter_cache_get_stats() - Get cache statistics
+ * @stats: Output
+ */
+void filter_cache_get_stats(struct filter_cache_stats *stats);
+
+/**
+ * filter_cache_clear() - Drop every program the cache holds
+ *
+ * References handed out stay valid.
+ */
+void filter_cache_clear(void);
+
+#endif /* FILTER_CACHE_H */
@@ -10,10 +10,13 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "filter_atom.h"
 
 /* Forward declaration */
 struct filter_expr;
 struct filter_node;
+struct sock_filter;
+struct filter_jit;
 
 /* Bytecode instruction opcodes */
 enum filter_opcode {
@@ -33,6 +36,7 @@ enum filter_opcode {
 	OP_MATCH,           /* =~ (regex match) */
 	OP_NMATCH,          /* !~ (regex not match) */
 	OP_IN,              /* IN (set membership) */
+	OP_IN_SET,          /* IN against a compiled atom set */
 	
 	/* Logical operations */
 	OP_AND,             /* Logical AND */
@@ -44,6 +48,15 @@ enum filter_opcode {
 	OP_JUMP_IF_FALSE,   /* Jump if top of stack is false */
 	OP_JUMP_IF_TRUE,    /* Jump if top of stack is true */
 	
+	/* Native predicates */
+	OP_CALL,            /* Call a predicate, push its result */
+	
+	/* Superinstructions, produced by filter_bytecode_optimize() */
+	OP_FIELD_CMP_NUMBER, /* field <cmp> number */
+	OP_FIELD_CMP_STRING, /* field <cmp> string, including =~ and !~ */
+	OP_FIELD_IN_RANGE,  /* field >= lower AND field <= upper */
+	OP_FIELD_IN_SET,    /* field IN atom set */
+	
 	/* Special */
 	OP_RETURN,          /* Return result */
 	OP_NOP,             /* No operation */
@@ -78,6 +91,28 @@ struct filter_instruction {
 		struct {
 			uint32_t count;  /* Number of items in set */
 		} in;
+		
+		/* For IN_SET operation */
+		struct {
+			uint32_t set_index;  /* Index into atom set table */
+		} set;
+		
+		/* For CALL */
+		struct {
+			int32_t predicate;   /* Id, see filter_predicate.h */
+			uint8_t arg;         /* enum filter_predicate_arg */
+			uint32_t string_index;
+			int64_t number;
+		} call;
+		
+		/* For the FIELD_* superinstructions, operands are immediates */
+		struct {
+			uint8_t field_type;
+			uint8_t cmp;         /* Comparison opcode */
+			uint32_t index;      /* String or set index */
+			int64_t value;       /* Number, or lower bound of a range */
+			int64_t upper;       /* Upper bound of a range */
+		} fused;
 	} operand;
 };
 
@@ -89,12 +124,25 @@ struct filter_bytecode {
 	
 	/* String constant table */
 	char **strings;
+	size_t *string_lens;
+	uint32_t *string_atoms;  /* Interned atom of each string */
 	size_t string_count;
 	size_t string_capacity;
 	
+	/* Atom sets of IN lists made only of string constants */
+	struct filter_atom_set *sets;
+	size_t set_count;
+	
 	/* Optimization statistics */
 	size_t original_instruction_count;
 	size_t optimizations_applied;
+	
+	/* Native code, see filter_jit.h */
+	_Atomic(struct filter_jit *) jit;
+	uint64_t profiled_evals;         /* Evaluations by filter_eval_with_profiling() */
+	bool jit_attempted;
+	
+	_Atomic unsigned int refs;       /* filter_compile() holds the first */
 };
 
 /**
@@ -115,8 +163,18 @@ struct filter_bytecode *filter_compile(struct filter_expr *expr);
 bool filter_compile_node(struct filter_node *node, struct filter_bytecode *bytecode);
 
 /**
- * filter_bytecode_free() - Free compiled bytecode
- * @bytecode: Bytecode to free
+ * filter_bytecode_ref() - Take another reference to bytecode
+ * @bytecode: Bytecode (can be NULL)
+ *
+ * Returns: @bytecode
+ */
+struct filter_bytecode *filter_bytecode_ref(struct filter_bytecode *bytecode);
+
+/**
+ * filter_bytecode_free() - Release a reference to bytecode
+ * @bytecode: Bytecode to release (can be NULL)
+ *
+ * The bytecode is freed with its last reference.
  */
 void filter_bytecode_free(struct filter_bytecode *bytecode);
 
@@ -125,6 +183,8 @@ void filter_bytecode_free(struct filter_bytecode *bytecode);
  * @bytecode: Bytecode to optimize
  *
  * Optimizations include:
+ * - Superinstructions, fusing a field, a constant and the comparison
+ *   of each predicate into one instruction without stack traffic
  * - Constant folding
  * - Dead code elimination
  * - Jump optimization
@@ -157,4 +217,51 @@ void filter_bytecode_stats(struct filter_bytecode *bytecode,
                            size_t *string_count,
                            size_t *optimizations);
 
+/* Protocol argument for sockets that carry more than one netlink protocol */
+#define FILTER_CBPF_ANY_PROTOCOL  (-1)
+
+/* Classic BPF socket prefilter */
+struct filter_cbpf {
+	struct sock_filter *insns;
+	unsigned short len;
+	bool relaxed;           /* Some predicates were left to user space */
+};
+
+/**
+ * filter_compile_cbpf() - Compile filter expression to a classic BPF prefilter
+ * @expr: Parsed filter expression
+ * @protocol: Netlink protocol of the target socket, or FILTER_CBPF_ANY_PROTOCOL
+ *            for the nlmon packet socket (protocol taken from skb->protocol)
+ * @prog: Output for the compiled program
+ *
+ * Only predicates on fixed-offset header fields (netlink.protocol,
+ * netlink.msg_type, netlink.msg_flags, netlink.seq, netlink.pid and the
+ * netlink.genl_* header fields) compared against numeric constants are
+ * compiled. Everything else is relaxed to "accept", so the program never
+ * drops a message the full filter would match and the expression must
+ * still be evaluated in user space. Control messages, multipart messages
+ * and datagrams carrying more than one message are always accepted.
+ *
+ * Returns: 0 on success, -ENOTSUP if no predicate can be evaluated in the
+ *          kernel, -E2BIG if the program exceeds classic BPF limits,
+ *          -ENOMEM on allocation failure
+ */
+int filter_compile_cbpf(struct filter_expr *expr, int protocol,
+                        struct filter_cbpf **prog);
+
+/**
+ * filter_cbpf_free() - Free classic BPF prefilter
+ * @prog: Program to free
+ */
+void filter_cbpf_free(struct filter_cbpf *prog);
+
+/**
+ * filter_cbpf_attach() - Attach classic BPF prefilter to a socket
+ * @fd: Packet or netlink socket
+ * @prog: Compiled program
+ *
+ * Returns: 0 on success, negative errno on failure
+ */
+int filter_cbpf_attach(int fd, const struct filter_cbpf *prog);
+
 #endif /* FILTER_COMPILER_H */
@@ -0,0 +1,79 @@
+/* filter_dag.h - Shared evaluation of many filters
+ *
+ * Merges filters into one DAG: comparisons are compiled once per
+ * distinct predicate and AND/OR/NOT nodes with the same operands are
+ * shared, each evaluated at most once per event. Filters whose top
+ * level conjunction contains a "field == constant" predicate are indexed
+ * by it, so an event only visits filters whose key it carries. Regex
+ * predicates without operators on the same field share one automaton.
+ */
+
+#ifndef FILTER_DAG_H
+#define FILTER_DAG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct filter_node;
+struct filter_eval_context;
+struct nlmon_event;
+struct filter_dag;
+
+/* Shape of a DAG */
+struct filter_dag_stats {
+	size_t filters;                 /* Filters added */
+	size_t keyed;                   /* Filters reached through the key index */
+	size_t predicates;              /* Distinct compiled predicates */
+	size_t literals;                /* Predicates matched by an automaton */
+	size_t nodes;                   /* Distinct nodes, predicates included */
+	uint64_t evals;                 /* Events evaluated */
+	uint64_t node_evals;            /* Nodes evaluated, after sharing */
+};
+
+/**
+ * filter_dag_create() - Create an empty DAG
+ *
+ * Returns: Pointer to DAG or NULL on error
+ */
+struct filter_dag *filter_dag_create(void);
+
+/**
+ * filter_dag_destroy() - Destroy a DAG
+ * @dag: DAG
+ */
+void filter_dag_destroy(struct filter_dag *dag);
+
+/**
+ * filter_dag_add() - Add a filter
+ * @dag: DAG
+ * @ast: Parsed filter, only read during the call
+ *
+ * Returns: Filter id, consecutive from 0 in the order of adding, or -1 on error
+ */
+int filter_dag_add(struct filter_dag *dag, const struct filter_node *ast);
+
+/**
+ * filter_dag_eval() - Evaluate all filters against an event
+ * @dag: DAG
+ * @event: Event to evaluate
+ * @ctx: Evaluation context for the predicates
+ * @ids: Output for the ids of matching filters, in ascending order
+ * @max_ids: Number of entries in @ids
+ *
+ * Each filter matches exactly when filter_eval() of it would.
+ *
+ * Returns: Number of matching filters, may exceed @max_ids
+ */
+size_t filter_dag_eval(struct filter_dag *dag, struct nlmon_event *event,
+                       struct filter_eval_context *ctx,
+                       uint32_t *ids, size_t max_ids);
+
+/**
+ * filter_dag_get_stats() - Get the shape and counters of a DAG
+ * @dag: DAG
+ * @stats: Output for the statistics
+ */
+void filter_dag_get_stats(struct filter_dag *dag, struct filter_dag_stats *stats);
+
+#endif /* FILTER_DAG_H */
@@ -10,7 +10,6 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <regex.h>
 
 /* Forward declarations */
 struct filter_bytecode;
@@ -23,30 +22,60 @@ enum filter_value_type {
 	FILTER_VALUE_STRING,
 };
 
-/* Stack value */
+/* Stack value
+ *
+ * Strings are borrowed views into the event or the bytecode string
+ * table, not necessarily NUL terminated, so the stack never owns memory.
+ * Constants and the interface name carry their atom, see filter_atom.h.
+ */
 struct filter_value {
 	enum filter_value_type type;
 	union {
 		bool bool_val;
 		int64_t number_val;
-		char *string_val;
+		struct {
+			const char *ptr;
+			size_t len;
+			uint32_t atom;
+		} string_val;
 	} data;
 };
 
+/* Default entries of a context's regex cache */
+#define FILTER_EVAL_REGEX_CACHE_DEFAULT 64
+
+/* Regex cache counters, see filter_eval_regex_stats() */
+struct filter_regex_stats {
+	uint64_t hits;                  /* Found in the context's cache */
+	uint64_t misses;                /* Fetched from the shared store */
+	uint64_t compiles;              /* Misses no context had compiled yet */
+	uint64_t evictions;             /* Least recently used entries dropped */
+	size_t entries;                 /* Entries in use */
+	size_t capacity;                /* Maximum entries */
+};
+
+struct regex_cache_entry;
+
 /* Evaluation context */
 struct filter_eval_context {
 	struct filter_value *stack;
 	size_t stack_size;
 	size_t stack_capacity;
 	
-	/* Regex cache for pattern matching */
-	struct {
-		char *pattern;
-		regex_t compiled;
-		bool valid;
-	} *regex_cache;
+	/* LRU cache of references into the shared pattern store, filter_regex.h */
+	struct regex_cache_entry *regex_cache;
+	uint32_t *regex_buckets;        /* Entry + 1 heading each hash chain */
+	size_t regex_bucket_mask;
 	size_t regex_cache_size;
 	size_t regex_cache_capacity;
+	uint32_t regex_lru_head;        /* Most recently used */
+	uint32_t regex_lru_tail;
+	struct filter_regex_stats regex_stats;
+	
+	/* Atom of the last interface name looked up */
+	char atom_interface[16];
+	uint32_t atom_generation;
+	uint32_t interface_atom;
 	
 	/* Performance profiling */
 	uint64_t eval_count;
@@ -76,7 +105,7 @@ void filter_eval_context_destroy(struct filter_eval_context *ctx);
  * filter_eval() - Evaluate filter bytecode against event
  * @bytecode: Compiled filter bytecode
  * @event: Event to evaluate
- * @ctx: Evaluation context (can be NULL for one-time evaluation)
+ * @ctx: Evaluation context (can be NULL to use one kept per thread)
  *
  * Returns: true if event matches filter, false otherwise
  */
@@ -84,6 +113,53 @@ bool filter_eval(struct filter_bytecode *bytecode,
                  struct nlmon_event *event,
                  struct filter_eval_context *ctx);
 
+/**
+ * filter_eval_predicate() - Evaluate bytecode telling errors from mismatches
+ * @bytecode: Compiled filter bytecode
+ * @event: Event to evaluate
+ * @ctx: Evaluation context (required)
+ *
+ * Always interprets. An error, such as a field the event does not carry,
+ * makes filter_eval() return false however deep inside NOT it happens,
+ * which callers combining several predicates need to reproduce.
+ *
+ * Returns: 1 if the event matches, 0 if not, -1 on error
+ */
+int filter_eval_predicate(struct filter_bytecode *bytecode,
+                          struct nlmon_event *event,
+                          struct filter_eval_context *ctx);
+
+/**
+ * filter_eval_batch() - Evaluate filter bytecode against many events
+ * @bytecode: Compiled filter bytecode
+ * @events: Events to evaluate, NULL entries never match
+ * @count: Number of events
+ * @ctx: Evaluation context (can be NULL to use one kept per thread)
+ * @matches: Output bitmap of (@count + 63) / 64 words, bit i % 64 of word
+ *           i / 64 set if @events[i] matches
+ *
+ * Same results as filter_eval() on each event, but each instruction is
+ * dispatched once per 64 events and numeric field comparisons run over a
+ * column of values. Suits batch handlers of the event processor. The
+ * opcode statistics count dispatches, not events.
+ *
+ * Returns: Number of matching events
+ */
+size_t filter_eval_batch(struct filter_bytecode *bytecode, struct nlmon_event **events,
+                         size_t count, struct filter_eval_context *ctx, uint64_t *matches);
+
+/**
+ * filter_eval_field() - Extract a field value from an event
+ * @ctx: Evaluation context (required)
+ * @event: Event
+ * @field_type: Field, see enum filter_field_type
+ * @value: Output for the value, strings borrow from @event
+ *
+ * Returns: true on success, false if the event does not carry the field
+ */
+bool filter_eval_field(struct filter_eval_context *ctx, struct nlmon_event *event,
+                       uint8_t field_type, struct filter_value *value);
+
 /**
  * filter_eval_with_profiling() - Evaluate filter with profiling enabled
  * @bytecode: Compiled filter bytecode
@@ -118,11 +194,30 @@ void filter_eval_stats(struct filter_eval_context *ctx,
  */
 void filter_eval_reset_stats(struct filter_eval_context *ctx);
 
+/**
+ * filter_eval_set_regex_cache_size() - Resize the regex cache
+ * @ctx: Evaluation context
+ * @entries: Maximum patterns cached, at least 1
+ *
+ * Drops all cached entries; the patterns stay compiled in the store.
+ *
+ * Returns: true on success, false on allocation failure
+ */
+bool filter_eval_set_regex_cache_size(struct filter_eval_context *ctx, size_t entries);
+
+/**
+ * filter_eval_regex_stats() - Get regex cache statistics
+ * @ctx: Evaluation context
+ * @stats: Output for the counters, reset by filter_eval_reset_stats()
+ */
+void filter_eval_regex_stats(struct filter_eval_context *ctx,
+                             struct filter_regex_stats *stats);
+
 /**
  * filter_eval_opcode_stats() - Get per-opcode statistics
  * @ctx: Evaluation context
  * @opcode: Opcode to query
- * @count: Output for execution count
+ * @count: Output for dispatches by the interpreter (native code is not counted)
  * @total_time_ns: Output for total time spent
  */
 void filter_eval_opcode_stats(struct filter_eval_context *ctx,
@@ -0,0 +1,96 @@
+/* filter_jit.h - Native code backend for filter bytecode
+ *
+ * Translates compiled bytecode into x86-64 machine code that calls the
+ * interpreter's instruction implementations directly, with jumps as
+ * native branches. This removes the dispatch loop; the interpreter stays
+ * the fallback wherever the JIT is unavailable or a filter is not hot.
+ */
+
+#ifndef FILTER_JIT_H
+#define FILTER_JIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "filter_compiler.h"
+
+struct filter_eval_context;
+struct nlmon_event;
+
+/* Evaluations through filter_eval_with_profiling() before a filter is compiled */
+#define FILTER_JIT_DEFAULT_THRESHOLD 4096
+
+/* Instruction implementation, see filter_eval_op() */
+typedef int (*filter_op_fn)(struct filter_eval_context *ctx,
+                            struct filter_bytecode *bytecode,
+                            struct nlmon_event *event,
+                            const struct filter_instruction *instr);
+
+/* Entry point of generated code, returns whether the event matches */
+typedef bool (*filter_jit_fn)(struct filter_eval_context *ctx,
+                              struct filter_bytecode *bytecode,
+                              struct nlmon_event *event);
+
+/**
+ * filter_jit_available() - Check for a native code backend
+ *
+ * Returns: true if this build can generate code for the host
+ */
+bool filter_jit_available(void);
+
+/**
+ * filter_jit_compile() - Generate native code for bytecode
+ * @bytecode: Compiled, and if wanted optimized, bytecode
+ *
+ * filter_eval() runs the generated code from then on. Compiling an
+ * already compiled filter does nothing.
+ *
+ * Returns: true on success, false if unavailable, the bytecode has
+ * jumps out of range or code memory could not be mapped
+ */
+bool filter_jit_compile(struct filter_bytecode *bytecode);
+
+/**
+ * filter_jit_run() - Run the native code of bytecode
+ * @bytecode: Bytecode
+ * @event: Event to evaluate
+ * @ctx: Evaluation context with an empty stack
+ * @result: Output for whether the event matches
+ *
+ * Returns: true if @bytecode has native code and it was run
+ */
+bool filter_jit_run(struct filter_bytecode *bytecode, struct nlmon_event *event,
+                    struct filter_eval_context *ctx, bool *result);
+
+/**
+ * filter_jit_release() - Drop the native code of bytecode
+ * @bytecode: Bytecode, no evaluation of it may be running
+ */
+void filter_jit_release(struct filter_bytecode *bytecode);
+
+/**
+ * filter_jit_set_threshold() - Set when profiled filters get compiled
+ * @evals: Profiled evaluations before compiling, 0 to never compile
+ */
+void filter_jit_set_threshold(uint64_t evals);
+
+/**
+ * filter_jit_threshold() - Get when profiled filters get compiled
+ *
+ * Returns: Profiled evaluations before compiling, 0 if disabled
+ */
+uint64_t filter_jit_threshold(void);
+
+/**
+ * filter_eval_op() - Get the implementation of an instruction
+ * @opcode: Opcode
+ *
+ * Used by the generated code. Implementations return -1 on error and 0
+ * otherwise. The one for the conditional jumps returns 0 or 1 for a
+ * false or true bool on top of the stack and 2 for any other value, the
+ * one for OP_RETURN returns 1 on a match and 0 otherwise.
+ *
+ * Returns: Implementation, NULL for OP_JUMP and OP_NOP
+ */
+filter_op_fn filter_eval_op(enum filter_opcode opcode);
+
+#endif /* FILTER_JIT_H */
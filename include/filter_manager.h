@@ -2,6 +2,10 @@
  *
  * Provides filter save/load, naming, organization, and validation.
  * Manages a collection of named filters with persistence.
+ *
+ * Changes may come from any thread and are serialized. Evaluation reads
+ * an immutable snapshot of the filters and never waits for a change, but
+ * shares one evaluation context, so at most one thread evaluates at once.
  */
 
 #ifndef FILTER_MANAGER_H
@@ -11,12 +15,19 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 /* Forward declarations */
 struct filter_expr;
 struct filter_bytecode;
 struct filter_eval_context;
 struct nlmon_event;
+struct filter_snapshot;
+struct filter_profile;
+
+/* Evaluations of a filter between samples of its profile */
+#define FILTER_MANAGER_SAMPLE_INTERVAL 64
 
 /* Filter entry in the manager */
 struct filter_entry {
@@ -25,11 +36,12 @@ struct filter_entry {
 	char *expression;                /* Filter expression string */
 	struct filter_expr *parsed;      /* Parsed AST */
 	struct filter_bytecode *compiled; /* Compiled bytecode */
+	struct filter_profile *profile;  /* See filter_manager_set_adaptive() */
 	
-	/* Statistics */
-	uint64_t eval_count;             /* Number of evaluations */
-	uint64_t match_count;            /* Number of matches */
-	uint64_t total_time_ns;          /* Total evaluation time */
+	/* Statistics, updated by evaluation without the manager lock */
+	_Atomic uint64_t eval_count;     /* Number of evaluations */
+	_Atomic uint64_t match_count;    /* Number of matches */
+	_Atomic uint64_t total_time_ns;  /* Total evaluation time */
 	
 	/* Metadata */
 	time_t created;                  /* Creation timestamp */
@@ -48,6 +60,19 @@ struct filter_manager {
 	
 	char *storage_path;              /* Path to filter storage file */
 	bool auto_save;                  /* Auto-save on changes */
+	
+	bool shared;                     /* See filter_manager_set_shared() */
+	bool adaptive;                   /* See filter_manager_set_adaptive() */
+	
+	/* Serializes changes, evaluation never takes it */
+	pthread_mutex_t lock;
+	
+	/* Published filters, replaced wholesale on every change */
+	_Atomic(struct filter_snapshot *) snapshot;
+	_Atomic unsigned readers[2];     /* Evaluations in progress per epoch */
+	_Atomic unsigned reader_epoch;
+	
+	_Atomic uint64_t version;        /* See filter_manager_get_version() */
 };
 
 /**
@@ -153,6 +178,43 @@ size_t filter_manager_eval_all(struct filter_manager *mgr,
                                const char **matches,
                                size_t max_matches);
 
+/**
+ * filter_manager_set_shared() - Evaluate all filters through one DAG
+ * @mgr: Filter manager
+ * @shared: Whether filter_manager_eval_all() uses shared evaluation
+ *
+ * Shared evaluation compiles common predicates once, evaluates them at
+ * most once per event and only visits filters whose "field == constant"
+ * key an event carries. Matches are the same as without it. Evaluation
+ * counts still cover every enabled filter but no time is attributed.
+ */
+void filter_manager_set_shared(struct filter_manager *mgr, bool shared);
+
+/**
+ * filter_manager_set_adaptive() - Profile filters for reordering
+ * @mgr: Filter manager
+ * @adaptive: Whether to sample the operands of each filter's AND/OR chains
+ *
+ * Every FILTER_MANAGER_SAMPLE_INTERVAL evaluations of a filter, one by
+ * one rather than through the shared DAG, evaluate each chain operand
+ * separately for its cost and selectivity. See filter_manager_reorder().
+ */
+void filter_manager_set_adaptive(struct filter_manager *mgr, bool adaptive);
+
+/**
+ * filter_manager_reorder() - Reorder filters by their profiles
+ * @mgr: Filter manager
+ *
+ * Recompiles every profiled filter whose chains are expected to get
+ * cheaper with the cheapest and most selective operands first, see
+ * filter_profile.h, and publishes them all at once. Matches, expressions
+ * and statistics stay the same, the profiles start over. Meant to be
+ * called periodically, never from inside an evaluation.
+ *
+ * Returns: Number of filters recompiled
+ */
+size_t filter_manager_reorder(struct filter_manager *mgr);
+
 /**
  * filter_manager_list() - List all filters
  * @mgr: Filter manager
@@ -165,6 +227,17 @@ size_t filter_manager_list(struct filter_manager *mgr,
                            const char **names,
                            size_t max_count);
 
+/**
+ * filter_manager_get_version() - Get version of the published filters
+ * @mgr: Filter manager
+ *
+ * The version goes up every time a change is published, so a caller can
+ * tell whether anything it derived from the filter list is still current.
+ *
+ * Returns: Current version, 0 before the first change
+ */
+uint64_t filter_manager_get_version(struct filter_manager *mgr);
+
 /**
  * filter_manager_save() - Save filters to storage file
  * @mgr: Filter manager
@@ -6,6 +6,7 @@
  * - Logical operators (AND, OR, NOT)
  * - Parentheses for grouping
  * - IN operator for set membership
+ * - Calls of native predicates, see filter_predicate.h
  */
 
 #ifndef FILTER_PARSER_H
@@ -38,6 +39,9 @@ enum filter_node_type {
 	FILTER_NODE_STRING,    /* String literal */
 	FILTER_NODE_NUMBER,    /* Numeric literal */
 	FILTER_NODE_LIST,      /* List of values for IN operator */
+	
+	/* Native predicate call, e.g. name("arg") */
+	FILTER_NODE_CALL,
 };
 
 /* Field types that can be filtered */
@@ -160,6 +164,12 @@ struct filter_node {
 			struct filter_node **items;
 			size_t count;
 		} list;
+		
+		/* For predicate calls */
+		struct {
+			int predicate;             /* Id, see filter_predicate.h */
+			struct filter_node *arg;   /* String or number literal, or NULL */
+		} call;
 	} data;
 };
 
@@ -200,6 +210,17 @@ void filter_expr_free(struct filter_expr *expr);
  */
 void filter_node_free(struct filter_node *node);
 
+/**
+ * filter_node_fallible() - Check whether a subtree may fail to evaluate
+ * @node: AST node
+ *
+ * Header fields are filled in for every event, the rest only for some,
+ * and evaluation fails on an event without a field it reads.
+ *
+ * Returns: true if @node reads a field events may not carry
+ */
+bool filter_node_fallible(const struct filter_node *node);
+
 /**
  * filter_expr_to_string() - Convert AST back to string representation
  * @expr: Filter expression
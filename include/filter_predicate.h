@@ -0,0 +1,134 @@
+/* filter_predicate.h - Native predicates callable from filter expressions
+ *
+ * A predicate is a C function registered under a name, which filter
+ * expressions call as name(), name("text") or name(42). The parser looks
+ * the name up and checks the argument against the declared type, the
+ * compiler emits a direct call. Calls are scheduled behind the plain
+ * comparisons of an AND/OR chain, the costlier the later.
+ *
+ * The registry is process wide. A name keeps its id for the life of the
+ * process, so filters compiled against it stay valid across unregister
+ * and register; a call to an unregistered predicate does not match.
+ * Predicates may run on several threads at once and must not have side
+ * effects the filter depends on.
+ */
+
+#ifndef FILTER_PREDICATE_H
+#define FILTER_PREDICATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FILTER_PREDICATE_MAX 64
+#define FILTER_PREDICATE_NAME_MAX 32
+
+struct nlmon_event;
+struct filter_node;
+
+/* Argument a predicate takes */
+enum filter_predicate_arg {
+	FILTER_PREDICATE_ARG_NONE,
+	FILTER_PREDICATE_ARG_STRING,
+	FILTER_PREDICATE_ARG_NUMBER,
+};
+
+/* Returns nonzero if the event matches, only the declared argument is set */
+typedef int (*filter_predicate_fn)(const struct nlmon_event *event, const char *string,
+                                   int64_t number, void *data);
+
+/**
+ * filter_predicate_register() - Register a native predicate
+ * @name: Identifier of letters, digits and '_', not starting with a digit
+ * @fn: Predicate
+ * @arg: Argument type
+ * @cost_ns: Expected time per call, orders calls among themselves
+ * @data: Passed to @fn
+ * @owner: Tag for filter_predicate_unregister_owner(), may be NULL
+ *
+ * Returns: Predicate id, -EINVAL for a bad name or argument type,
+ *          -EEXIST if @name is registered, -ENOSPC if the table is full
+ */
+int filter_predicate_register(const char *name, filter_predicate_fn fn,
+                              enum filter_predicate_arg arg, uint32_t cost_ns,
+                              void *data, const void *owner);
+
+/**
+ * filter_predicate_replace() - Hand a predicate to a new owner
+ * @name: Name @old_owner registered
+ * @fn: Predicate
+ * @arg: Argument type, as registered, since compiled calls pass that one
+ * @cost_ns: Expected time per call
+ * @data: Passed to @fn
+ * @old_owner: Tag the predicate is registered with
+ * @owner: New tag
+ *
+ * Waits for the calls to the old function first, as unregistering does;
+ * calls in between do not match.
+ *
+ * Returns: Predicate id, -ENOENT if @old_owner has no predicate @name,
+ *          -EINVAL for a bad function or a different argument type
+ */
+int filter_predicate_replace(const char *name, filter_predicate_fn fn,
+                             enum filter_predicate_arg arg, uint32_t cost_ns,
+                             void *data, const void *old_owner, const void *owner);
+
+/**
+ * filter_predicate_unregister() - Unregister a predicate
+ * @name: Name it was registered under
+ *
+ * Waits for calls in progress, so @fn and @data may be freed afterwards.
+ *
+ * Returns: 0 on success, -ENOENT if @name is not registered
+ */
+int filter_predicate_unregister(const char *name);
+
+/**
+ * filter_predicate_unregister_owner() - Unregister all predicates of an owner
+ * @owner: Tag given at registration, not NULL
+ *
+ * Returns: Number of predicates unregistered
+ */
+int filter_predicate_unregister_owner(const void *owner);
+
+/**
+ * filter_predicate_lookup() - Find a registered predicate
+ * @name: Name
+ * @arg: Output for the argument type (can be NULL)
+ *
+ * Returns: Predicate id, or -1 if @name is not registered
+ */
+int filter_predicate_lookup(const char *name, enum filter_predicate_arg *arg);
+
+/**
+ * filter_predicate_name() - Get the name of a predicate id
+ * @id: Predicate id
+ *
+ * Returns: Name, or NULL for an id never registered
+ */
+const char *filter_predicate_name(int id);
+
+/**
+ * filter_predicate_node_cost() - Declared cost of the calls in a subtree
+ * @node: AST node
+ *
+ * Every call counts at least 1, so any subtree with a call sorts behind
+ * the ones without.
+ *
+ * Returns: Sum of the declared costs, 0 without calls
+ */
+uint64_t filter_predicate_node_cost(const struct filter_node *node);
+
+/**
+ * filter_predicate_call() - Call a predicate
+ * @id: Predicate id
+ * @event: Event
+ * @string: String argument, for FILTER_PREDICATE_ARG_STRING
+ * @number: Number argument, for FILTER_PREDICATE_ARG_NUMBER
+ *
+ * Returns: true if the predicate is registered and matches
+ */
+bool filter_predicate_call(int id, const struct nlmon_event *event,
+                           const char *string, int64_t number);
+
+#endif /* FILTER_PREDICATE_H */
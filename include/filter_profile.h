@@ -0,0 +1,86 @@
+/* filter_profile.h - Cost based ordering of AND/OR chains
+ *
+ * A profile samples how long each operand of a filter's AND and OR
+ * chains takes and how often it is true, then reorders the operands so
+ * that the chain is expected to stop as cheaply as possible: AND
+ * operands by cost over the chance of being false, OR operands by cost
+ * over the chance of being true.
+ *
+ * Ordering must not change results. An operand reading a field the
+ * event may not carry fails the whole filter when evaluated, so only the
+ * operands in front of the first such one are ever moved.
+ */
+
+#ifndef FILTER_PROFILE_H
+#define FILTER_PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Samples a profile needs before it reorders anything */
+#define FILTER_PROFILE_MIN_SAMPLES 256
+
+/* Fraction of a chain's expected cost a new order must stay below */
+#define FILTER_PROFILE_GAIN 0.9
+
+struct filter_expr;
+struct filter_eval_context;
+struct nlmon_event;
+struct filter_profile;
+
+/**
+ * filter_profile_create() - Create a profile of a filter's chains
+ * @expr: Parsed filter, must outlive the profile
+ *
+ * Returns: Pointer to profile or NULL on error
+ */
+struct filter_profile *filter_profile_create(struct filter_expr *expr);
+
+/**
+ * filter_profile_destroy() - Destroy a profile
+ * @profile: Profile (can be NULL)
+ */
+void filter_profile_destroy(struct filter_profile *profile);
+
+/**
+ * filter_profile_sample() - Evaluate every chain operand on one event
+ * @profile: Profile
+ * @event: Event
+ * @ctx: Evaluation context (required)
+ *
+ * Costs a full evaluation of each operand, so callers sample only a
+ * fraction of their events. Safe against a concurrent reorder decision.
+ */
+void filter_profile_sample(struct filter_profile *profile, struct nlmon_event *event,
+                           struct filter_eval_context *ctx);
+
+/**
+ * filter_profile_reorder() - Reorder the chains of the profiled filter
+ * @profile: Profile with at least FILTER_PROFILE_MIN_SAMPLES samples
+ *
+ * Relinks the AST the profile was created from in place, the expression
+ * has to be compiled again to take effect. Chains are only changed when
+ * the new order is expected to cost under FILTER_PROFILE_GAIN of the old.
+ *
+ * Returns: true if any chain changed
+ */
+bool filter_profile_reorder(struct filter_profile *profile);
+
+/**
+ * filter_profile_restore() - Undo filter_profile_reorder()
+ * @profile: Profile
+ *
+ * Relinks every chain in the order the profile was created with.
+ */
+void filter_profile_restore(struct filter_profile *profile);
+
+/**
+ * filter_profile_samples() - Get the number of samples taken
+ * @profile: Profile
+ *
+ * Returns: Number of filter_profile_sample() calls
+ */
+uint64_t filter_profile_samples(const struct filter_profile *profile);
+
+#endif /* FILTER_PROFILE_H */
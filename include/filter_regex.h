@@ -0,0 +1,87 @@
+/* filter_regex.h - Compiled regex patterns shared by all contexts
+ *
+ * Evaluation contexts keep a small LRU cache of references into one
+ * process wide store of compiled patterns. A pattern is compiled once
+ * and then only read, so a context missing its cache costs a locked
+ * lookup rather than a regcomp(). Patterns without operators are kept
+ * as a plain substring instead of a compiled regex.
+ */
+
+#ifndef FILTER_REGEX_H
+#define FILTER_REGEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <regex.h>
+
+/* Distinct patterns the store keeps while unused, later ones are freed */
+#define FILTER_REGEX_RETAINED_MAX 4096
+
+/* Compiled pattern, immutable once returned by filter_regex_get() */
+struct filter_regex {
+	char *pattern;
+	size_t pattern_len;
+	uint32_t hash;
+
+	char *literal;                  /* Substring, if no regex is needed */
+	size_t literal_len;
+	regex_t compiled;
+	bool invalid;                   /* Did not compile, matches nothing */
+
+	/* Owned by the store */
+	uint32_t refs;
+	bool retained;                  /* Store holds a reference */
+	struct filter_regex *next;
+};
+
+/**
+ * filter_regex_hash() - Hash a pattern
+ * @pattern: Pattern, need not be NUL terminated
+ * @len: Length of @pattern
+ *
+ * Returns: Hash, the one filter_regex_get() stores
+ */
+uint32_t filter_regex_hash(const char *pattern, size_t len);
+
+/**
+ * filter_regex_get() - Get a reference to a compiled pattern
+ * @pattern: Extended regex, need not be NUL terminated
+ * @len: Length of @pattern
+ * @hash: filter_regex_hash() of @pattern
+ * @compiled: Output for whether this call compiled it (can be NULL)
+ *
+ * A pattern that fails to compile is stored too, as invalid.
+ *
+ * Returns: Reference to release with filter_regex_put(), NULL on
+ * allocation failure
+ */
+struct filter_regex *filter_regex_get(const char *pattern, size_t len,
+                                      uint32_t hash, bool *compiled);
+
+/**
+ * filter_regex_put() - Release a reference
+ * @regex: Reference from filter_regex_get() (can be NULL)
+ */
+void filter_regex_put(struct filter_regex *regex);
+
+/**
+ * filter_regex_match() - Match a text against a pattern
+ * @regex: Pattern
+ * @text: Text, need not be NUL terminated
+ * @len: Length of @text
+ *
+ * Safe to call from several threads on the same pattern.
+ *
+ * Returns: true if @regex matches somewhere in @text
+ */
+bool filter_regex_match(const struct filter_regex *regex, const char *text, size_t len);
+
+/**
+ * filter_regex_cleanup() - Free all retained patterns
+ *
+ * Only for process teardown, after every context has been destroyed.
+ */
+void filter_regex_cleanup(void);
+
+#endif /* FILTER_REGEX_H */
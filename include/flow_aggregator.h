@@ -0,0 +1,156 @@
+/* flow_aggregator.h - Conntrack events folded into per-interval flow summaries
+ *
+ * Conntrack events make up most of the event volume while saying little
+ * each: a flow is created, updated a few times and destroyed. The
+ * aggregator folds them into one summary per flow key and interval, with
+ * the events, new and destroyed flows, the packets and bytes moved in the
+ * interval and the lifetimes of the flows that ended. Storage and export
+ * then see the summaries instead of the events, and only events matching
+ * an explicit passthrough predicate go downstream as they are.
+ *
+ * Conntrack counters are cumulative, so the last counters of each flow
+ * are kept in a conntrack mirror to turn them into per-interval amounts.
+ *
+ * Intervals are aligned to multiples of their length on the event clock.
+ * A summary table that fills up folds further keys into one overflow
+ * summary with no addresses, so memory stays bounded under a flow flood.
+ *
+ * All functions are safe from any number of threads.
+ */
+
+#ifndef FLOW_AGGREGATOR_H
+#define FLOW_AGGREGATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Forward declarations */
+struct nlmon_event;
+
+/* Defaults for a configuration field left at 0 */
+#define FLOW_AGGREGATOR_DEFAULT_INTERVAL 60        /* Seconds */
+#define FLOW_AGGREGATOR_DEFAULT_SUMMARIES 65536
+
+/* What the flows of an interval are summarized by */
+enum flow_aggregation_key {
+	FLOW_KEY_TUPLE = 0,             /* Protocol, addresses and ports */
+	FLOW_KEY_HOSTS,                 /* Protocol and addresses, ports rolled up */
+};
+
+/* Flows of one key in one interval */
+struct flow_summary {
+	int family;                      /* AF_INET, AF_INET6, 0 for the overflow summary */
+	uint8_t protocol;                /* IPPROTO_* */
+	char src_addr[64];               /* Original direction source */
+	char dst_addr[64];               /* Original direction destination */
+	uint16_t src_port;               /* 0 when summarized by hosts */
+	uint16_t dst_port;
+	uint64_t interval_start;         /* Nanoseconds since the epoch */
+	uint64_t interval_end;
+	uint64_t first_event;            /* Timestamps of the events folded in */
+	uint64_t last_event;
+	uint64_t events;
+	uint64_t flows_new;
+	uint64_t flows_destroyed;
+	uint64_t packets_orig;           /* Moved in the interval */
+	uint64_t packets_reply;
+	uint64_t bytes_orig;
+	uint64_t bytes_reply;
+	uint64_t duration_total_ns;      /* Lifetimes of the flows destroyed */
+	uint64_t duration_max_ns;
+};
+
+/* Called for each summary of a finished interval, outside of any lock */
+typedef void (*flow_summary_callback_t)(const struct flow_summary *summary, void *ctx);
+
+/* Whether a conntrack event also goes downstream as it is */
+typedef bool (*flow_passthrough_t)(struct nlmon_event *event, void *ctx);
+
+/* Aggregator configuration */
+struct flow_aggregator_config {
+	unsigned int interval;           /* Seconds per summary interval */
+	enum flow_aggregation_key key;
+	size_t max_summaries;            /* Summaries per interval before overflow */
+	size_t max_flows;                /* Flows whose counters are kept, 0 for the mirror default */
+	flow_summary_callback_t emit;    /* Receives the summaries */
+	void *emit_ctx;
+	flow_passthrough_t passthrough;  /* Can be NULL to fold every conntrack event */
+	void *passthrough_ctx;
+};
+
+/* Aggregator statistics */
+struct flow_aggregator_stats {
+	uint64_t events_folded;          /* Conntrack events taken in */
+	uint64_t events_passed;          /* Of which also passed downstream */
+	uint64_t summaries_emitted;
+	uint64_t intervals;              /* Intervals finished */
+	uint64_t overflowed;             /* Events folded into an overflow summary */
+	size_t summaries;                /* Summaries of the current interval */
+};
+
+/* Aggregator (opaque) */
+struct flow_aggregator;
+
+/**
+ * flow_aggregator_create() - Create a flow aggregator
+ * @config: Configuration, emit is required
+ *
+ * Returns: Aggregator or NULL on error
+ */
+struct flow_aggregator *flow_aggregator_create(const struct flow_aggregator_config *config);
+
+/**
+ * flow_aggregator_destroy() - Destroy a flow aggregator
+ * @agg: Aggregator
+ *
+ * The current interval is dropped, call flow_aggregator_flush() first to
+ * keep it.
+ */
+void flow_aggregator_destroy(struct flow_aggregator *agg);
+
+/**
+ * flow_aggregator_process() - Fold an event into the summaries
+ * @agg: Aggregator
+ * @event: Event about to go downstream
+ *
+ * Conntrack events are folded into the summary of their interval, an event
+ * of a later interval finishing the current one first. Other events are
+ * left alone.
+ *
+ * Returns: true if the event still goes downstream, that is if it is not a
+ * conntrack event or it matches the passthrough predicate
+ */
+bool flow_aggregator_process(struct flow_aggregator *agg, struct nlmon_event *event);
+
+/**
+ * flow_aggregator_tick() - Finish the current interval if it is over
+ * @agg: Aggregator
+ * @now: Nanoseconds since the epoch
+ *
+ * Call periodically so the summaries of a quiet interval do not wait for
+ * the next conntrack event.
+ *
+ * Returns: Number of summaries emitted
+ */
+size_t flow_aggregator_tick(struct flow_aggregator *agg, uint64_t now);
+
+/**
+ * flow_aggregator_flush() - Finish the current interval now
+ * @agg: Aggregator
+ *
+ * For shutdown and tests, the summaries of the interval so far are
+ * emitted and a later event of the same interval starts new ones.
+ *
+ * Returns: Number of summaries emitted
+ */
+size_t flow_aggregator_flush(struct flow_aggregator *agg);
+
+/**
+ * flow_aggregator_get_stats() - Get aggregator statistics
+ * @agg: Aggregator
+ * @stats: Output for the statistics
+ */
+void flow_aggregator_get_stats(struct flow_aggregator *agg, struct flow_aggregator_stats *stats);
+
+#endif /* FLOW_AGGREGATOR_H */
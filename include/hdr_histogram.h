@@ -0,0 +1,180 @@
+/* hdr_histogram.h - Log-linear histograms with lock-free recording
+ *
+ * Buckets grow by a factor of 2^(2^-schema), the layout of Prometheus
+ * native histograms: bucket key k holds values in (base^(k-1), base^k].
+ * Each power of two is split into 2^schema buckets, so any quantile is
+ * within about 2^(2^-schema) - 1 of the true value, 4.4% at the default
+ * schema 3 and 0.27% at schema 8, without choosing bucket boundaries.
+ *
+ * Buckets span HDR_HISTOGRAM_MIN_EXP to HDR_HISTOGRAM_MAX_EXP powers of
+ * two. Values at or below HDR_HISTOGRAM_ZERO_THRESHOLD, negative values
+ * included, are counted in the zero bucket and larger values than the
+ * range in the top bucket. Count, sum, min and max are kept exactly.
+ *
+ * Any number of threads can record at once, every update is an atomic
+ * operation on the histogram. Readers see each counter atomically but
+ * not all of them at one instant.
+ */
+
+#ifndef HDR_HISTOGRAM_H
+#define HDR_HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+
+/* Schemas, buckets per power of two is 2^schema */
+#define HDR_HISTOGRAM_MIN_SCHEMA 0
+#define HDR_HISTOGRAM_MAX_SCHEMA 8
+#define HDR_HISTOGRAM_DEFAULT_SCHEMA 3
+
+/* Range of the buckets, 2^MIN_EXP to 2^MAX_EXP */
+#define HDR_HISTOGRAM_MIN_EXP (-32)
+#define HDR_HISTOGRAM_MAX_EXP 40
+
+/* Upper bound of the zero bucket, 2^HDR_HISTOGRAM_MIN_EXP */
+#define HDR_HISTOGRAM_ZERO_THRESHOLD 2.3283064365386963e-10
+
+/* Key to start hdr_histogram_next_bucket() from */
+#define HDR_HISTOGRAM_FIRST_KEY INT_MIN
+
+/* HDR histogram (opaque) */
+struct hdr_histogram;
+
+/**
+ * hdr_histogram_create() - Create an empty histogram
+ * @schema: HDR_HISTOGRAM_MIN_SCHEMA to HDR_HISTOGRAM_MAX_SCHEMA
+ *
+ * Takes 8 bytes per bucket, 72 * 2^@schema buckets.
+ *
+ * Returns: Histogram or NULL on error
+ */
+struct hdr_histogram *hdr_histogram_create(int schema);
+
+/**
+ * hdr_histogram_destroy() - Destroy histogram
+ * @h: Histogram (can be NULL)
+ */
+void hdr_histogram_destroy(struct hdr_histogram *h);
+
+/**
+ * hdr_histogram_record() - Record one value
+ * @h: Histogram
+ * @value: Value, NaN is ignored
+ */
+void hdr_histogram_record(struct hdr_histogram *h, double value);
+
+/**
+ * hdr_histogram_reset() - Forget every recorded value
+ * @h: Histogram
+ *
+ * Values recorded while the reset runs may be partly kept.
+ */
+void hdr_histogram_reset(struct hdr_histogram *h);
+
+/**
+ * hdr_histogram_merge() - Add the values of one histogram to another
+ * @dst: Histogram added to
+ * @src: Histogram added, not recorded to meanwhile for an exact result
+ *
+ * A bucket of @src goes to the bucket of @dst holding its upper bound,
+ * exact when @dst has the same or a lower schema.
+ */
+void hdr_histogram_merge(struct hdr_histogram *dst, const struct hdr_histogram *src);
+
+/**
+ * hdr_histogram_schema() - Get the schema of a histogram
+ * @h: Histogram
+ *
+ * Returns: Schema passed to hdr_histogram_create()
+ */
+int hdr_histogram_schema(const struct hdr_histogram *h);
+
+/**
+ * hdr_histogram_count() - Get the number of recorded values
+ * @h: Histogram
+ *
+ * Returns: Number of values
+ */
+uint64_t hdr_histogram_count(const struct hdr_histogram *h);
+
+/**
+ * hdr_histogram_sum() - Get the sum of recorded values
+ * @h: Histogram
+ *
+ * Returns: Sum of values
+ */
+double hdr_histogram_sum(const struct hdr_histogram *h);
+
+/**
+ * hdr_histogram_min() - Get the smallest recorded value
+ * @h: Histogram
+ *
+ * Returns: Smallest value, +INFINITY when empty
+ */
+double hdr_histogram_min(const struct hdr_histogram *h);
+
+/**
+ * hdr_histogram_max() - Get the largest recorded value
+ * @h: Histogram
+ *
+ * Returns: Largest value, -INFINITY when empty
+ */
+double hdr_histogram_max(const struct hdr_histogram *h);
+
+/**
+ * hdr_histogram_zero_count() - Get the count of the zero bucket
+ * @h: Histogram
+ *
+ * Returns: Values at or below HDR_HISTOGRAM_ZERO_THRESHOLD
+ */
+uint64_t hdr_histogram_zero_count(const struct hdr_histogram *h);
+
+/**
+ * hdr_histogram_next_bucket() - Find the next non-empty bucket
+ * @h: Histogram
+ * @key: Key of the last bucket returned, HDR_HISTOGRAM_FIRST_KEY to start;
+ *       updated to the key of the bucket found
+ * @count: Output for the bucket's count
+ *
+ * Returns: true if a bucket was found, false after the last one
+ */
+bool hdr_histogram_next_bucket(const struct hdr_histogram *h, int *key, uint64_t *count);
+
+/**
+ * hdr_histogram_bucket_upper() - Get the upper bound of a bucket
+ * @schema: Schema of the histogram
+ * @key: Bucket key
+ *
+ * The lower bound of bucket @key is the upper bound of @key - 1.
+ *
+ * Returns: 2^(@key / 2^@schema)
+ */
+double hdr_histogram_bucket_upper(int schema, int key);
+
+/**
+ * hdr_histogram_count_at_most() - Count values up to a bound
+ * @h: Histogram
+ * @bound: Upper bound
+ *
+ * Counts the zero bucket and every bucket whose upper bound is at most
+ * @bound, exact when @bound is a bucket boundary.
+ *
+ * Returns: Number of values
+ */
+uint64_t hdr_histogram_count_at_most(const struct hdr_histogram *h, double bound);
+
+/**
+ * hdr_histogram_quantile() - Estimate a quantile
+ * @h: Histogram
+ * @q: Quantile from 0 to 1, e.g. 0.999
+ *
+ * Interpolates within the bucket holding the quantile and clamps the
+ * result to the recorded min and max.
+ *
+ * Returns: Estimated value, NaN when empty
+ */
+double hdr_histogram_quantile(const struct hdr_histogram *h, double q);
+
+#endif /* HDR_HISTOGRAM_H */
@@ -0,0 +1,281 @@
+/* hot_upgrade.h - Socket handoff and state transfer between processes
+ *
+ * A running nlmon listens on a UNIX socket. A new binary started with the
+ * same path connects to it and asks to take over, the old one stops
+ * reading its sockets and sends them over SCM_RIGHTS together with
+ * sections of saved state, then exits once the new one confirms. Netlink
+ * and packet sockets stay open throughout, the kernel keeps queueing on
+ * them while they change hands, so no event is missed or read twice.
+ *
+ * Sections are opaque byte strings identified by type. Record sections
+ * hold arrays of fixed size structures and carry that size: a binary
+ * whose structure differs gets no records rather than garbage, and
+ * rebuilds that state the way it would after a restart.
+ *
+ * Nothing here is thread-safe, each handoff belongs to one thread.
+ */
+
+#ifndef HOT_UPGRADE_H
+#define HOT_UPGRADE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NLMON_UPGRADE_MAGIC 0x4e4c5550          /* "NLUP" */
+#define NLMON_UPGRADE_VERSION 1
+#define NLMON_UPGRADE_MAX_FDS 16                /* Sockets one handoff carries */
+#define NLMON_UPGRADE_MAX_SECTION (256u << 20)  /* Largest section accepted */
+#define NLMON_UPGRADE_TIMEOUT_MS 10000          /* Each step of the exchange */
+#define NLMON_UPGRADE_START_TIMEOUT_MS 60000    /* New process starting up */
+
+/* What a handed over socket is for */
+enum nlmon_upgrade_fd_role {
+	NLMON_UPGRADE_FD_NL_ROUTE = 1,
+	NLMON_UPGRADE_FD_NL_GENERIC,
+	NLMON_UPGRADE_FD_NL_DIAG,
+	NLMON_UPGRADE_FD_NL_NETFILTER,
+	NLMON_UPGRADE_FD_CAPTURE,       /* Packet socket of the nlmon device */
+	NLMON_UPGRADE_FD_WEB,           /* Listening socket of the web server */
+};
+
+/* What a section holds */
+enum nlmon_upgrade_section_type {
+	NLMON_UPGRADE_SEC_EVENT_LOG = 1,  /* Records of char[256], oldest first */
+	NLMON_UPGRADE_SEC_FILTER,         /* Filter expression, NUL terminated */
+	NLMON_UPGRADE_SEC_CONFIG,         /* Configuration file path, NUL terminated */
+	NLMON_UPGRADE_SEC_FIB_MIRROR,     /* Records of struct fib_mirror_route */
+	NLMON_UPGRADE_SEC_NEIGH_MIRROR,   /* Records of struct neigh_mirror_entry */
+	NLMON_UPGRADE_SEC_CT_MIRROR,      /* Records of struct ct_mirror_entry */
+};
+
+struct fib_mirror;
+struct neigh_mirror;
+struct ct_mirror;
+
+/* Sockets and sections of one handoff (opaque) */
+struct nlmon_upgrade;
+
+/**
+ * nlmon_upgrade_create() - Create an empty handoff
+ *
+ * Returns: Handoff or NULL on error
+ */
+struct nlmon_upgrade *nlmon_upgrade_create(void);
+
+/**
+ * nlmon_upgrade_destroy() - Destroy a handoff
+ * @up: Handoff, may be NULL
+ *
+ * Received sockets not taken with nlmon_upgrade_take_fd() are closed,
+ * sockets added for sending are not.
+ */
+void nlmon_upgrade_destroy(struct nlmon_upgrade *up);
+
+/**
+ * nlmon_upgrade_add_fd() - Add a socket to send
+ * @up: Handoff
+ * @role: NLMON_UPGRADE_FD_*
+ * @fd: Socket, still owned by the caller
+ *
+ * Returns: 0, -EEXIST for a role already added, -ENOSPC, -EINVAL
+ */
+int nlmon_upgrade_add_fd(struct nlmon_upgrade *up, unsigned int role, int fd);
+
+/**
+ * nlmon_upgrade_take_fd() - Take a received socket
+ * @up: Handoff
+ * @role: NLMON_UPGRADE_FD_*
+ *
+ * Returns: Socket now owned by the caller, -1 if none was sent
+ */
+int nlmon_upgrade_take_fd(struct nlmon_upgrade *up, unsigned int role);
+
+/**
+ * nlmon_upgrade_add_section() - Add a section to send
+ * @up: Handoff
+ * @type: NLMON_UPGRADE_SEC_*
+ * @data: Contents, copied
+ * @len: Size of @data
+ *
+ * Returns: 0, -EEXIST for a type already added, -E2BIG, -ENOMEM, -EINVAL
+ */
+int nlmon_upgrade_add_section(struct nlmon_upgrade *up, uint32_t type,
+                              const void *data, size_t len);
+
+/**
+ * nlmon_upgrade_add_records() - Add a section of fixed size records
+ * @up: Handoff
+ * @type: NLMON_UPGRADE_SEC_*
+ * @records: Array, copied
+ * @size: Size of one record
+ * @count: Number of records
+ *
+ * Returns: As nlmon_upgrade_add_section()
+ */
+int nlmon_upgrade_add_records(struct nlmon_upgrade *up, uint32_t type,
+                              const void *records, size_t size, size_t count);
+
+/**
+ * nlmon_upgrade_get_section() - Find a received section
+ * @up: Handoff
+ * @type: NLMON_UPGRADE_SEC_*
+ * @len: Output for its size
+ *
+ * Returns: Contents, valid until nlmon_upgrade_destroy(), NULL if not sent
+ */
+const void *nlmon_upgrade_get_section(const struct nlmon_upgrade *up, uint32_t type,
+                                      size_t *len);
+
+/**
+ * nlmon_upgrade_get_records() - Find a received record section
+ * @up: Handoff
+ * @type: NLMON_UPGRADE_SEC_*
+ * @size: Size of one record as this binary knows it
+ * @count: Output for the number of records
+ *
+ * Returns: Records, NULL with *@count 0 if not sent or sent with another
+ * record size
+ */
+const void *nlmon_upgrade_get_records(const struct nlmon_upgrade *up, uint32_t type,
+                                      size_t size, size_t *count);
+
+/**
+ * nlmon_upgrade_add_fib() - Save a routing mirror into a section
+ * @up: Handoff
+ * @fib: Mirror
+ *
+ * Returns: 0 or negative errno
+ */
+int nlmon_upgrade_add_fib(struct nlmon_upgrade *up, struct fib_mirror *fib);
+
+/**
+ * nlmon_upgrade_add_neigh() - Save a neighbor mirror into a section
+ * @up: Handoff
+ * @mirror: Mirror
+ *
+ * Returns: 0 or negative errno
+ */
+int nlmon_upgrade_add_neigh(struct nlmon_upgrade *up, struct neigh_mirror *mirror);
+
+/**
+ * nlmon_upgrade_add_ct() - Save a conntrack mirror into a section
+ * @up: Handoff
+ * @mirror: Mirror
+ *
+ * Returns: 0 or negative errno
+ */
+int nlmon_upgrade_add_ct(struct nlmon_upgrade *up, struct ct_mirror *mirror);
+
+/**
+ * nlmon_upgrade_restore_fib() - Fill a routing mirror from its section
+ * @up: Received handoff
+ * @fib: Mirror, normally empty
+ *
+ * Returns: Routes restored, 0 without a usable section
+ */
+long nlmon_upgrade_restore_fib(const struct nlmon_upgrade *up, struct fib_mirror *fib);
+
+/**
+ * nlmon_upgrade_restore_neigh() - Fill a neighbor mirror from its section
+ * @up: Received handoff
+ * @mirror: Mirror, normally empty
+ *
+ * The recency order of the saved mirror is kept.
+ *
+ * Returns: Neighbors restored, 0 without a usable section
+ */
+long nlmon_upgrade_restore_neigh(const struct nlmon_upgrade *up, struct neigh_mirror *mirror);
+
+/**
+ * nlmon_upgrade_restore_ct() - Fill a conntrack mirror from its section
+ * @up: Received handoff
+ * @mirror: Mirror, normally empty
+ *
+ * The recency order of the saved mirror is kept.
+ *
+ * Returns: Flows restored, 0 without a usable section
+ */
+long nlmon_upgrade_restore_ct(const struct nlmon_upgrade *up, struct ct_mirror *mirror);
+
+/**
+ * nlmon_upgrade_listen() - Listen for a process taking over
+ * @path: Socket path, a stale socket there is replaced
+ *
+ * Returns: Non-blocking listening socket, or negative errno
+ */
+int nlmon_upgrade_listen(const char *path);
+
+/**
+ * nlmon_upgrade_accept() - Accept a process taking over
+ * @listen_fd: Socket of nlmon_upgrade_listen()
+ *
+ * Returns: Connection, or negative errno; -EAGAIN if nobody is connecting
+ */
+int nlmon_upgrade_accept(int listen_fd);
+
+/**
+ * nlmon_upgrade_connect() - Connect to the running process
+ * @path: Socket path
+ *
+ * Returns: Connection, -ENOENT or -ECONNREFUSED if no process listens,
+ * other negative errno
+ */
+int nlmon_upgrade_connect(const char *path);
+
+/**
+ * nlmon_upgrade_request() - Ask the running process to hand over
+ * @conn: Connection of nlmon_upgrade_connect()
+ *
+ * Returns: 0 or negative errno
+ */
+int nlmon_upgrade_request(int conn);
+
+/**
+ * nlmon_upgrade_wait_request() - Wait for the new process to ask
+ * @conn: Connection of nlmon_upgrade_accept()
+ *
+ * Returns: 0, -EPROTO for a peer speaking another version, negative errno
+ */
+int nlmon_upgrade_wait_request(int conn);
+
+/**
+ * nlmon_upgrade_send() - Send the sockets and sections
+ * @conn: Connection
+ * @up: Handoff
+ *
+ * Returns: 0 or negative errno
+ */
+int nlmon_upgrade_send(int conn, const struct nlmon_upgrade *up);
+
+/**
+ * nlmon_upgrade_recv() - Receive the sockets and sections
+ * @conn: Connection
+ * @out: Output for the handoff
+ *
+ * Returns: 0, -EPROTO for a malformed handoff, negative errno
+ */
+int nlmon_upgrade_recv(int conn, struct nlmon_upgrade **out);
+
+/**
+ * nlmon_upgrade_done() - Tell the old process it can exit
+ * @conn: Connection
+ * @status: 0 once the sockets are in use, negative errno to have the old
+ *          process resume
+ *
+ * Returns: 0 or negative errno
+ */
+int nlmon_upgrade_done(int conn, int status);
+
+/**
+ * nlmon_upgrade_wait_done() - Wait for the new process to take over
+ * @conn: Connection
+ *
+ * Waits up to NLMON_UPGRADE_START_TIMEOUT_MS. A new process that cannot
+ * tell the old one it took over must exit, as the old one resumes.
+ *
+ * Returns: 0 if it did, the status it sent, or negative errno if it went
+ * away, in which case the old process must resume
+ */
+int nlmon_upgrade_wait_done(int conn);
+
+#endif /* HOT_UPGRADE_H */
@@ -0,0 +1,125 @@
+/* huge_alloc.h - Huge page backed allocation of large arrays
+ *
+ * Rings, pools and buffer columns of millions of entries spread over
+ * enough 4K pages to miss the TLB on most accesses. Arrays allocated
+ * here are mapped from reserved huge pages (MAP_HUGETLB) or advised to
+ * be transparent huge pages (MADV_HUGEPAGE), falling back from the one
+ * to the other and to ordinary pages as the kernel allows. Arrays below
+ * the configured minimum, or all of them with the backend off, come
+ * from calloc() as before.
+ *
+ * Mapped arrays are listed so that their huge page coverage, what the
+ * kernel actually backs with huge pages, can be reported.
+ */
+
+#ifndef HUGE_ALLOC_H
+#define HUGE_ALLOC_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Forward declarations */
+struct nlmon_stats_snapshot;
+
+/* Huge pages used by the backend */
+enum huge_alloc_mode {
+	HUGE_ALLOC_OFF,                 /* calloc(), unless an allocation insists */
+	HUGE_ALLOC_THP,                 /* Transparent huge pages */
+	HUGE_ALLOC_HUGETLB,             /* Reserved huge pages, else transparent ones */
+};
+
+/* Backend configuration, 0 takes the default */
+struct huge_alloc_config {
+	enum huge_alloc_mode mode;
+	size_t min_size;                /* Smallest array mapped, 2MB */
+	bool prefault;                  /* Fault mapped arrays in when allocated */
+};
+
+/* Map even with the backend off or below the minimum */
+#define HUGE_ALLOC_FORCE 0x1
+
+/* Backing of a mapped array */
+enum huge_alloc_kind {
+	HUGE_KIND_PAGES,                /* Ordinary pages, the kernel gave no huge ones */
+	HUGE_KIND_THP,
+	HUGE_KIND_HUGETLB,
+};
+
+/* A mapped array */
+struct huge_alloc_region {
+	const char *owner;
+	size_t size;                    /* Bytes mapped */
+	enum huge_alloc_kind kind;
+	size_t huge_bytes;              /* Bytes backed by huge pages now */
+};
+
+/* Totals of the mapped arrays */
+struct huge_alloc_stats {
+	size_t regions;
+	size_t bytes;
+	size_t hugetlb_bytes;
+	size_t thp_bytes;               /* Backed by transparent huge pages now */
+};
+
+/**
+ * huge_alloc_configure() - Set the backend configuration
+ * @config: Configuration
+ *
+ * Applies to later allocations; call before creating the rings and
+ * pools that should use it.
+ */
+void huge_alloc_configure(const struct huge_alloc_config *config);
+
+/**
+ * huge_calloc() - Allocate a zeroed array
+ * @nmemb: Number of elements
+ * @size: Element size
+ * @flags: HUGE_ALLOC_* flags
+ * @owner: Static name of the user, for the statistics
+ *
+ * Returns: Array to release with huge_free(), NULL on error
+ */
+void *huge_calloc(size_t nmemb, size_t size, unsigned int flags, const char *owner);
+
+/**
+ * huge_free() - Free an array of huge_calloc()
+ * @ptr: Array (can be NULL)
+ */
+void huge_free(void *ptr);
+
+/**
+ * huge_alloc_backed() - Whether an array was given huge pages
+ * @ptr: Array of huge_calloc()
+ *
+ * True for reserved huge pages, and for transparent ones once the
+ * kernel accepted the advice, whether or not it backed them yet.
+ */
+bool huge_alloc_backed(const void *ptr);
+
+/**
+ * huge_alloc_get_stats() - Read the totals of the mapped arrays
+ * @stats: Output
+ *
+ * Transparent huge page coverage is read from /proc/self/smaps, so this
+ * is not for hot paths.
+ */
+void huge_alloc_get_stats(struct huge_alloc_stats *stats);
+
+/**
+ * huge_alloc_for_each() - Read each mapped array
+ * @fn: Called per array with the list locked
+ * @ctx: Passed to @fn
+ */
+void huge_alloc_for_each(void (*fn)(const struct huge_alloc_region *region, void *ctx),
+                         void *ctx);
+
+/**
+ * huge_alloc_collect_stats() - Stats bus collector
+ * @snapshot: Snapshot to fill
+ * @ctx: Unused
+ *
+ * Fills the huge pages part, see stats_bus_add_source().
+ */
+void huge_alloc_collect_stats(struct nlmon_stats_snapshot *snapshot, void *ctx);
+
+#endif /* HUGE_ALLOC_H */
@@ -0,0 +1,84 @@
+/* id_table.h - Growable hash table keyed by integer IDs
+ *
+ * Open addressing table for caches keyed by interface index, namespace
+ * inode and the like. Entries are stored inline and start with struct
+ * id_slot. The load is kept at or below one half, and removal shifts
+ * the rest of a probe run back instead of leaving tombstones, so a
+ * lookup stops at the first free slot.
+ *
+ * Growing and removing move entries, so pointers into the table are
+ * only good until the next id_table_get() or id_table_remove(). The
+ * table is not synchronized.
+ */
+
+#ifndef ID_TABLE_H
+#define ID_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Header of every entry */
+struct id_slot {
+	uint64_t key;
+	int used;
+};
+
+/* Table of entries of one type, defined with ID_TABLE_INIT() */
+struct id_table {
+	char *slots;
+	size_t entry_size;
+	size_t size;                     /* Power of two, 0 until first insert */
+	size_t used;
+};
+
+/* Initializer for an empty table of entries of the given type */
+#define ID_TABLE_INIT(type) { .slots = NULL, .entry_size = sizeof(type), .size = 0, .used = 0 }
+
+/**
+ * id_table_find() - Look up an entry
+ * @table: Table
+ * @key: ID
+ *
+ * Returns: Entry or NULL if the ID is not in the table
+ */
+void *id_table_find(const struct id_table *table, uint64_t key);
+
+/**
+ * id_table_get() - Look up an entry, adding it if it is new
+ * @table: Table
+ * @key: ID
+ * @created: Set to 1 if the entry was added zeroed, 0 if it existed
+ *
+ * Returns: Entry or NULL if the table could not grow
+ */
+void *id_table_get(struct id_table *table, uint64_t key, int *created);
+
+/**
+ * id_table_remove() - Remove an entry
+ * @table: Table
+ * @entry: Entry returned by a lookup or id_table_slot()
+ *
+ * When removing while walking slots with id_table_slot(), look at the
+ * same slot again afterwards, as a later entry may have moved into it.
+ */
+void id_table_remove(struct id_table *table, void *entry);
+
+/**
+ * id_table_slot() - Slot by position, for walking the table
+ * @table: Table
+ * @i: Position below @table->size
+ *
+ * Returns: The slot, which is an entry only if its used field is set
+ */
+static inline struct id_slot *id_table_slot(const struct id_table *table, size_t i)
+{
+	return (struct id_slot *)(table->slots + i * table->entry_size);
+}
+
+/**
+ * id_table_free() - Free all entries, leaving an empty table
+ * @table: Table
+ */
+void id_table_free(struct id_table *table);
+
+#endif /* ID_TABLE_H */
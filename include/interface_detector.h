@@ -1,6 +1,7 @@
 #ifndef INTERFACE_DETECTOR_H
 #define INTERFACE_DETECTOR_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <linux/if.h>
 #include <linux/netlink.h>
@@ -76,7 +77,24 @@ struct interface_info {
 	} type_info;
 };
 
-/* Interface detector context */
+/* Deepest stack of interfaces followed, against loops */
+#define INTERFACE_MAX_DEPTH 32
+
+/* Place of an interface in the topology */
+struct interface_link {
+	char name[IFNAMSIZ];
+	int ifindex;
+	interface_type_t type;
+	int master;                      /* Bridge or bond it is enslaved to, 0 if none */
+	int link;                        /* IFLA_LINK, the lower device or a peer */
+	int parent;                      /* master, else the device it is stacked on */
+	uint16_t vlan_id;
+	unsigned int num_children;       /* Interfaces whose parent it is */
+};
+
+/* Interface detector context. The topology is kept from link events
+ * passed to interface_detector_update(), queries only follow links and
+ * may come from any thread. */
 struct interface_detector;
 
 /* Initialize interface detector */
@@ -106,13 +124,42 @@ int interface_detector_parse_bond(struct interface_detector *detector,
                                   struct nlmsghdr *nlh,
                                   struct bond_info *bond);
 
-/* Get interface hierarchy (parent/child relationships) */
+/* Apply RTM_NEWLINK or RTM_DELLINK to the topology. Returns 1 if it was
+ * applied, 0 for other messages, -1 on error. */
+int interface_detector_update(struct interface_detector *detector,
+                              struct nlmsghdr *nlh);
+
+/* Get interface hierarchy (parent/child relationships). The parent is
+ * 0 for a top level interface and -1 for one not seen in RTM_NEWLINK.
+ * Returns the number of children stored. */
 int interface_detector_get_hierarchy(struct interface_detector *detector,
                                      int ifindex,
                                      int *parent_ifindex,
                                      int *child_ifindices,
                                      int max_children);
 
+/* Get the place of an interface in the topology, -1 if not seen */
+int interface_detector_get_link(struct interface_detector *detector, int ifindex,
+                                struct interface_link *link);
+
+/* Get the cached name of an interface, -1 if not known */
+int interface_detector_get_name(struct interface_detector *detector, int ifindex,
+                                char *name, size_t len);
+
+/* Get the parents of an interface, nearest first. Returns the depth,
+ * which may exceed max_ancestors. */
+int interface_detector_get_ancestors(struct interface_detector *detector, int ifindex,
+                                     int *ancestors, int max_ancestors);
+
+/* Get the ports of a bridge or slaves of a bond. Returns the number
+ * stored. */
+int interface_detector_get_members(struct interface_detector *detector, int master,
+                                   int *members, int max_members);
+
+/* Check whether an interface is somewhere below another */
+int interface_detector_is_under(struct interface_detector *detector, int ifindex,
+                                int ancestor);
+
 /* Convert interface type to string */
 const char *interface_type_to_string(interface_type_t type);
 
@@ -0,0 +1,155 @@
+/* io_recv.h - Multishot socket receive through io_uring
+ *
+ * Receives datagrams from a set of sockets without a system call per
+ * datagram. Every socket gets one multishot recvmsg that stays armed,
+ * and the kernel places each datagram in a buffer it picks from a ring
+ * provided for that socket. The owner reaps a batch of completions per
+ * io_uring_enter(), and can wait on the ring descriptor in its own
+ * event loop. Buffers come from an nlmon_nl_msgpool and are handed back
+ * to the kernel as soon as the handler returns.
+ *
+ * Needs Linux 6.0 for multishot recvmsg with provided buffer rings,
+ * io_recv_create() fails on older kernels so callers can fall back to
+ * poll() and recv().
+ */
+
+#ifndef IO_RECV_H
+#define IO_RECV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+
+struct nlmon_nl_msgpool;
+
+/* Defaults */
+#define IO_RECV_DEFAULT_BUFFERS 64
+#define IO_RECV_DEFAULT_BUFFER_SIZE (32 * 1024)
+#define IO_RECV_MAX_SOURCES 8
+
+/* Receiver configuration */
+struct io_recv_config {
+	unsigned int buffer_count;      /* Buffers per socket, a power of two (0=default) */
+	size_t buffer_size;             /* Bytes per buffer, header included (0=default) */
+	struct nlmon_nl_msgpool *pool;  /* Buffer memory, NULL for a private pool */
+};
+
+/* Received datagram, valid until the handler returns */
+struct io_recv_msg {
+	void *data;
+	size_t len;                     /* Bytes received */
+	const void *name;               /* Source address, NULL unless asked for */
+	socklen_t namelen;
+	bool truncated;                 /* Datagram did not fit the buffer */
+};
+
+/* Receiver statistics */
+struct io_recv_stats {
+	uint64_t datagrams;
+	uint64_t bytes;
+	uint64_t truncated;
+	uint64_t errors;                /* Receive errors passed to handlers */
+	uint64_t rearms;                /* Multishot receives the kernel ended and that were re-armed */
+	uint64_t exhausted;             /* Receives that ended on a dry buffer ring */
+	uint64_t batches;               /* io_recv_run() calls that handled completions */
+	unsigned int sources;
+	unsigned int buffers;           /* Buffers across all sockets */
+};
+
+/**
+ * typedef io_recv_fn - Datagram handler
+ * @ctx: Context given to io_recv_add()
+ * @source: Source the datagram arrived on
+ * @msg: Datagram, or NULL on an error
+ * @error: 0, or the negative errno the socket reported
+ *
+ * Called from io_recv_run(). -ENOBUFS means the socket dropped datagrams,
+ * and the receive is re-armed after it. Other errors leave the source
+ * idle until io_recv_set_fd() gives it a socket again.
+ */
+typedef void (*io_recv_fn)(void *ctx, int source, const struct io_recv_msg *msg, int error);
+
+/* Receiver handle (opaque) */
+struct io_recv;
+
+/**
+ * io_recv_create() - Create a receiver
+ * @config: Receiver configuration (NULL for defaults)
+ *
+ * Returns: Receiver or NULL with errno set, e.g. to ENOSYS or EPERM when
+ *          io_uring is unavailable and EINVAL when the kernel lacks
+ *          provided buffer rings
+ */
+struct io_recv *io_recv_create(const struct io_recv_config *config);
+
+/**
+ * io_recv_destroy() - Cancel all receives and destroy the receiver
+ * @rx: Receiver
+ */
+void io_recv_destroy(struct io_recv *rx);
+
+/**
+ * io_recv_add() - Start receiving from a socket
+ * @rx: Receiver
+ * @fd: Datagram socket
+ * @namelen: Bytes of source address to pass to @fn, 0 for none
+ * @fn: Datagram handler
+ * @ctx: Handler context
+ *
+ * The receive is submitted by the next io_recv_run().
+ *
+ * Returns: Source number or negative errno
+ */
+int io_recv_add(struct io_recv *rx, int fd, socklen_t namelen, io_recv_fn fn, void *ctx);
+
+/**
+ * io_recv_set_fd() - Move a source to another socket
+ * @rx: Receiver
+ * @source: Source number
+ * @fd: New socket, or -1 to stop receiving
+ *
+ * Cancels the receive on the old socket, which the kernel keeps open
+ * until then, and arms one on @fd. Meant for reconnects, and may be
+ * called from the handler.
+ *
+ * Returns: 0 or negative errno
+ */
+int io_recv_set_fd(struct io_recv *rx, int source, int fd);
+
+/**
+ * io_recv_run() - Submit pending receives and handle completions
+ * @rx: Receiver
+ * @wait: Block until at least one completion arrives
+ *
+ * Handlers run on the calling thread. io_recv_add(), io_recv_set_fd()
+ * and io_recv_run() must not be called concurrently.
+ *
+ * Returns: Datagrams and errors handled, or negative errno
+ */
+int io_recv_run(struct io_recv *rx, bool wait);
+
+/**
+ * io_recv_wake() - Make a blocked io_recv_run() return
+ * @rx: Receiver
+ *
+ * Safe from any thread.
+ */
+void io_recv_wake(struct io_recv *rx);
+
+/**
+ * io_recv_get_fd() - Descriptor that polls readable with completions ready
+ * @rx: Receiver
+ *
+ * Returns: Ring descriptor
+ */
+int io_recv_get_fd(struct io_recv *rx);
+
+/**
+ * io_recv_get_stats() - Get receiver statistics
+ * @rx: Receiver
+ * @stats: Output statistics
+ */
+void io_recv_get_stats(struct io_recv *rx, struct io_recv_stats *stats);
+
+#endif /* IO_RECV_H */
@@ -0,0 +1,92 @@
+/* io_ring.h - Mapped io_uring shared by the I/O services
+ *
+ * Sets up and maps an io_uring through the raw system calls, so the
+ * services need no liburing. The caller serializes submissions and is
+ * the only consumer of the completion queue.
+ */
+
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/* Mapped io_uring */
+struct io_ring {
+	int fd;
+	unsigned int features;            /* IORING_FEAT_* the kernel reported */
+	void *sq_map;
+	size_t sq_map_size;
+	void *cq_map;
+	size_t cq_map_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	
+	_Atomic unsigned int *sq_head;
+	_Atomic unsigned int *sq_tail;
+	unsigned int sq_mask;
+	unsigned int *sq_array;
+	
+	_Atomic unsigned int *cq_head;
+	_Atomic unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+/**
+ * io_ring_setup() - Create and map a ring
+ * @ring: Ring to set up
+ * @entries: Submission queue entries
+ * @cq_entries: Completion queue entries, 0 for the kernel's default of
+ *              twice @entries
+ *
+ * Returns: 0 on success, -1 with errno set on error
+ */
+int io_ring_setup(struct io_ring *ring, unsigned int entries, unsigned int cq_entries);
+
+/**
+ * io_ring_close() - Unmap and close a ring
+ * @ring: Ring from io_ring_setup(), or zeroed with fd -1
+ *
+ * Requests still in flight are cancelled by the kernel.
+ */
+void io_ring_close(struct io_ring *ring);
+
+/**
+ * io_ring_sqe() - Take the next submission queue entry
+ * @ring: Ring
+ * @tail: Local submission tail, advanced past the entry
+ *
+ * The caller guarantees a free entry, e.g. by bounding its requests in
+ * flight by the ring size. The entry is zeroed.
+ *
+ * Returns: Entry to fill in
+ */
+struct io_uring_sqe *io_ring_sqe(struct io_ring *ring, unsigned int *tail);
+
+/**
+ * io_ring_submit() - Publish entries and hand them to the kernel
+ * @ring: Ring
+ * @tail: Local submission tail from io_ring_sqe()
+ * @count: Entries taken since the last publish
+ */
+void io_ring_submit(struct io_ring *ring, unsigned int tail, unsigned int count);
+
+/**
+ * io_ring_enter() - io_uring_enter(2)
+ *
+ * Returns: As the system call, -1 with errno set on error
+ */
+int io_ring_enter(struct io_ring *ring, unsigned int to_submit, unsigned int min_complete,
+                  unsigned int flags);
+
+/**
+ * io_ring_register() - io_uring_register(2)
+ *
+ * Returns: As the system call, -1 with errno set on error
+ */
+int io_ring_register(struct io_ring *ring, unsigned int opcode, const void *arg,
+                     unsigned int nr_args);
+
+#endif /* IO_RING_H */
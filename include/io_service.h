@@ -0,0 +1,146 @@
+/* io_service.h - Asynchronous file write service
+ *
+ * Carries out file writes and fsyncs for the exporters and storage
+ * writers off the calling thread, through io_uring where the kernel
+ * allows it and on a writer thread otherwise. Data is handed over in
+ * buffers taken from the service, registered with the ring so the
+ * kernel does not map them per write, and recycled on completion.
+ */
+
+#ifndef IO_SERVICE_H
+#define IO_SERVICE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Defaults */
+#define IO_SERVICE_DEFAULT_BUFFERS 16
+#define IO_SERVICE_DEFAULT_BUFFER_SIZE (64 * 1024)
+
+/* Write flags */
+#define IO_WRITE_DATASYNC 0x1           /* fdatasync the file once the write is done */
+
+/* Service configuration */
+struct io_service_config {
+	size_t buffer_count;            /* Buffers, and so writes in flight (0=default) */
+	size_t buffer_size;             /* Bytes per buffer (0=default) */
+	bool no_uring;                  /* Use the writer thread even where io_uring works */
+};
+
+/* Write buffer, owned by the service */
+struct io_buffer {
+	void *data;
+	size_t size;                    /* Capacity */
+	size_t len;                     /* Bytes to write */
+};
+
+/* Service statistics */
+struct io_service_stats {
+	uint64_t writes;                /* Completed buffer writes */
+	uint64_t syncs;                 /* Completed fdatasyncs */
+	uint64_t bytes;                 /* Bytes written */
+	uint64_t errors;                /* Writes that failed */
+	uint64_t buffer_waits;          /* Callers that waited for a free buffer */
+	bool uring;                     /* io_uring backend, else the writer thread */
+	bool registered;                /* Buffers registered with the ring */
+};
+
+/* Completion callback, result is 0 or a negative errno */
+typedef void (*io_complete_t)(void *ctx, int result);
+
+/* Write service handle (opaque) */
+struct io_service;
+
+/**
+ * io_service_create() - Create a write service
+ * @config: Service configuration (NULL for defaults)
+ *
+ * Falls back to the writer thread when the kernel or a seccomp policy
+ * refuses io_uring, and to unregistered buffers when registering them
+ * fails, e.g. over RLIMIT_MEMLOCK.
+ *
+ * Returns: Service handle or NULL on error
+ */
+struct io_service *io_service_create(const struct io_service_config *config);
+
+/**
+ * io_service_destroy() - Wait for all writes and destroy the service
+ * @svc: Service handle
+ */
+void io_service_destroy(struct io_service *svc);
+
+/**
+ * io_service_buffer() - Take a free buffer
+ * @svc: Service handle
+ *
+ * Waits while all buffers are in flight. The buffer goes back to the
+ * service with io_service_write() or io_service_release().
+ *
+ * Returns: Buffer with len 0, or NULL without a service
+ */
+struct io_buffer *io_service_buffer(struct io_service *svc);
+
+/**
+ * io_service_release() - Return a buffer without writing it
+ * @svc: Service handle
+ * @buf: Buffer from io_service_buffer()
+ */
+void io_service_release(struct io_service *svc, struct io_buffer *buf);
+
+/**
+ * io_service_write() - Write a buffer at an offset
+ * @svc: Service handle
+ * @fd: File to write, open until the completion
+ * @offset: File offset of the first byte
+ * @buf: Buffer from io_service_buffer(), with len bytes set
+ * @flags: IO_WRITE_* flags
+ * @done: Completion callback (NULL for none)
+ * @ctx: Callback context
+ *
+ * Writes in flight may complete in any order, which is why every write
+ * names its offset. With IO_WRITE_DATASYNC the fdatasync is linked to
+ * the write and runs once the write succeeded. done is called on the
+ * service's completion thread, after which the buffer is recycled.
+ *
+ * Returns: true if submitted, false on invalid arguments
+ */
+bool io_service_write(struct io_service *svc, int fd, uint64_t offset,
+                      struct io_buffer *buf, unsigned int flags,
+                      io_complete_t done, void *ctx);
+
+/**
+ * io_service_write_data() - Copy data into buffers and write them
+ * @svc: Service handle
+ * @fd: File to write, open until the completions
+ * @offset: File offset of the first byte
+ * @data: Data to write
+ * @len: Length of data
+ * @flags: IO_WRITE_* flags, applied to every buffer
+ * @done: Completion callback, called once per buffer (NULL for none)
+ * @ctx: Callback context
+ *
+ * Returns: true if submitted, false on invalid arguments
+ */
+bool io_service_write_data(struct io_service *svc, int fd, uint64_t offset,
+                           const void *data, size_t len, unsigned int flags,
+                           io_complete_t done, void *ctx);
+
+/**
+ * io_service_wait() - Wait until no write is in flight
+ * @svc: Service handle
+ *
+ * Covers the writes of every user of the service, and buffers taken
+ * but not yet written. Call it before a file with writes in flight is
+ * closed or renamed.
+ */
+void io_service_wait(struct io_service *svc);
+
+/**
+ * io_service_get_stats() - Get service statistics
+ * @svc: Service handle
+ * @stats: Output statistics
+ */
+void io_service_get_stats(struct io_service *svc, struct io_service_stats *stats);
+
+#endif /* IO_SERVICE_H */
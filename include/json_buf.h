@@ -0,0 +1,136 @@
+/* json_buf.h - Growable output buffer for building JSON text
+ *
+ * Serializers append to one reusable buffer instead of printing piece by
+ * piece, then hand the whole text to a single write() or send(). Strings
+ * are escaped through a lookup table, skipping runs of characters that
+ * need no escaping 16 bytes at a time where SSE2 is available, and
+ * integers are formatted without printf.
+ *
+ * A failed allocation marks the buffer failed and later appends do
+ * nothing, so a serializer can append a whole document and check once.
+ * Buffers do not lock, callers serialize access to each buffer.
+ */
+
+#ifndef JSON_BUF_H
+#define JSON_BUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* JSON output buffer */
+struct json_buf {
+	char *data;                     /* Text, NUL terminated once non-empty */
+	size_t len;
+	size_t cap;
+	bool failed;                    /* An allocation failed */
+};
+
+/**
+ * json_buf_init() - Initialize an empty buffer
+ * @buf: Buffer
+ * @cap: Bytes to allocate up front, 0 to allocate on first append
+ *
+ * Returns: true on success, false if the allocation failed
+ */
+bool json_buf_init(struct json_buf *buf, size_t cap);
+
+/**
+ * json_buf_free() - Free the buffer's memory
+ * @buf: Buffer (can be NULL)
+ */
+void json_buf_free(struct json_buf *buf);
+
+/**
+ * json_buf_reset() - Empty the buffer, keeping its memory for reuse
+ * @buf: Buffer
+ */
+void json_buf_reset(struct json_buf *buf);
+
+/**
+ * json_buf_reserve() - Make room for more bytes
+ * @buf: Buffer
+ * @extra: Bytes about to be appended
+ *
+ * Returns: true if @extra bytes fit, false if the buffer failed
+ */
+bool json_buf_reserve(struct json_buf *buf, size_t extra);
+
+/**
+ * json_buf_detach() - Take the text out of the buffer
+ * @buf: Buffer, left empty
+ *
+ * Returns: NUL terminated text the caller frees, NULL if the buffer
+ * failed or the allocation did
+ */
+char *json_buf_detach(struct json_buf *buf);
+
+/**
+ * json_buf_append() - Append raw bytes
+ * @buf: Buffer
+ * @data: Bytes, already valid JSON text
+ * @len: Number of bytes
+ */
+void json_buf_append(struct json_buf *buf, const char *data, size_t len);
+
+/**
+ * json_buf_append_str() - Append a raw NUL terminated string
+ * @buf: Buffer
+ * @str: String, already valid JSON text
+ */
+static inline void json_buf_append_str(struct json_buf *buf, const char *str)
+{
+	json_buf_append(buf, str, strlen(str));
+}
+
+/**
+ * json_buf_append_char() - Append one raw character
+ * @buf: Buffer
+ * @c: Character
+ */
+void json_buf_append_char(struct json_buf *buf, char c);
+
+/**
+ * json_buf_append_u64() - Append an unsigned integer in decimal
+ * @buf: Buffer
+ * @value: Value
+ */
+void json_buf_append_u64(struct json_buf *buf, uint64_t value);
+
+/**
+ * json_buf_append_u64_padded() - Append an unsigned integer, zero padded
+ * @buf: Buffer
+ * @value: Value
+ * @width: Least number of digits, at most 20
+ *
+ * Formats like printf's "%0*lu", for the microseconds of a timestamp.
+ */
+void json_buf_append_u64_padded(struct json_buf *buf, uint64_t value, int width);
+
+/**
+ * json_buf_append_i64() - Append a signed integer in decimal
+ * @buf: Buffer
+ * @value: Value
+ */
+void json_buf_append_i64(struct json_buf *buf, int64_t value);
+
+/**
+ * json_buf_append_escaped() - Append the escaped contents of a string
+ * @buf: Buffer
+ * @str: String bytes
+ * @len: Number of bytes
+ *
+ * Quotes, backslashes and control characters are escaped, nothing is
+ * added around the text.
+ */
+void json_buf_append_escaped(struct json_buf *buf, const char *str, size_t len);
+
+/**
+ * json_buf_append_string() - Append a quoted and escaped string
+ * @buf: Buffer
+ * @str: NUL terminated string, NULL appends null
+ */
+void json_buf_append_string(struct json_buf *buf, const char *str);
+
+#endif /* JSON_BUF_H */
@@ -23,10 +23,14 @@ struct json_rotation_policy {
 	size_t max_file_size;      /* Maximum file size before rotation (bytes) */
 	size_t max_rotations;      /* Maximum number of rotated files to keep */
 	bool compress_rotated;     /* Compress rotated files with gzip */
+	int compress_level;        /* gzip level 1-9, 0 for the default */
+	int compress_threads;      /* Compression threads, 0 for one */
 };
 
 /* JSON exporter handle (opaque) */
 struct json_exporter;
+struct io_service;
+struct correlation_result;
 
 /* Event structure for JSON export */
 struct json_event {
@@ -39,7 +43,8 @@ struct json_event {
 	const char *interface;
 	const char *namespace;
 	const char *details;       /* JSON string with additional details */
-	const char *correlation_id;
+	const struct correlation_result *correlation; /* Correlation the event is part of */
+	uint32_t sample_weight;    /* Written when above 1, see event_sampler.h */
 };
 
 /**
@@ -80,6 +85,21 @@ bool json_exporter_write_event(struct json_exporter *exporter,
  */
 bool json_exporter_flush(struct json_exporter *exporter);
 
+/**
+ * json_exporter_set_io_service() - Write batches through an I/O service
+ * @exporter: JSON exporter handle
+ * @io: Write service (NULL to write on the caller's thread again)
+ *
+ * Pending output is written first. Batches written to a file then go
+ * to the service instead of a blocking write(), stdout is still written
+ * directly. json_exporter_flush() waits for the service, so its result
+ * covers the writes handed over since the last flush, and rotation
+ * waits before the file is closed.
+ *
+ * Returns: true on success, false on error
+ */
+bool json_exporter_set_io_service(struct json_exporter *exporter, struct io_service *io);
+
 /**
  * json_exporter_get_stats() - Get exporter statistics
  * @exporter: JSON exporter handle
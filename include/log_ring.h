@@ -0,0 +1,222 @@
+/* log_ring.h - Deferred binary logging
+ *
+ * A log site records a pointer to its static descriptor, which holds the
+ * format, and the raw values of its arguments. Once nlmon_log_start() has
+ * run, records go into a ring and a background thread formats them and
+ * hands the text to the sink, so neither formatting nor I/O happen on the
+ * thread that logged. Before that, or after nlmon_log_stop(), records are
+ * formatted and delivered on the spot.
+ *
+ * Arguments are captured by value when logging but formatted later: %s
+ * arguments must be string literals or other strings that outlive the
+ * record. Sites that need anything else, such as text built from the
+ * arguments, format the record themselves with a render callback.
+ *
+ * The level check belongs to the caller and comes before NLMON_LOG(), so
+ * a disabled site evaluates none of its arguments.
+ */
+
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Levels, the same values as enum nlmon_nl_log_level */
+enum nlmon_log_level {
+	NLMON_LOG_ERROR = 0,
+	NLMON_LOG_WARN = 1,
+	NLMON_LOG_INFO = 2,
+	NLMON_LOG_DEBUG = 3,
+};
+
+#define NLMON_LOG_MAX_ARGS 8            /* Arguments one record can hold */
+#define NLMON_LOG_RING_DEFAULT 4096     /* Records, power of two */
+#define NLMON_LOG_IDLE_MS 5             /* Writer sleep while the ring is empty */
+#define NLMON_LOG_LINE_MAX 512          /* Longest formatted message */
+
+struct nlmon_log_record;
+
+/**
+ * struct nlmon_log_site - Static description of one log site
+ * @fmt: printf format of the arguments, unused with @render
+ * @tag: Source prefix such as "NETLINK", NULL for none
+ * @level: NLMON_LOG_* level
+ * @render: Formats the record instead of @fmt, may be NULL; returns what
+ *          snprintf() would
+ */
+struct nlmon_log_site {
+	const char *fmt;
+	const char *tag;
+	uint8_t level;
+	int (*render)(const struct nlmon_log_record *rec, char *buf, size_t len);
+};
+
+/**
+ * struct nlmon_log_record - One logged message before formatting
+ * @ts_ns: Wall clock time of the log call
+ * @site: Site that logged it, which identifies the format
+ * @nargs: Number of @args used
+ * @args: Raw argument values, see NLMON_LOG_ARG()
+ */
+struct nlmon_log_record {
+	uint64_t ts_ns;
+	const struct nlmon_log_site *site;
+	uint32_t nargs;
+	uint64_t args[NLMON_LOG_MAX_ARGS];
+};
+
+/**
+ * typedef nlmon_log_sink_fn - Receiver of formatted messages
+ * @rec: Record the message was formatted from
+ * @text: Message without timestamp or level, no trailing newline
+ * @ctx: Sink context
+ *
+ * Called on the writer thread while the ring runs, on the logging thread
+ * otherwise.
+ */
+typedef void (*nlmon_log_sink_fn)(const struct nlmon_log_record *rec,
+                                  const char *text, void *ctx);
+
+/* Ring statistics */
+struct nlmon_log_stats {
+	uint64_t logged;        /* Records submitted */
+	uint64_t dropped;       /* Records lost to a full ring */
+	uint64_t delivered;     /* Records handed to the sink */
+};
+
+/**
+ * nlmon_log_set_sink() - Install the receiver of messages
+ * @fn: Sink, NULL for nlmon_log_default_sink()
+ * @ctx: Passed to @fn
+ */
+void nlmon_log_set_sink(nlmon_log_sink_fn fn, void *ctx);
+
+/**
+ * nlmon_log_default_sink() - Write a message to stderr
+ * @rec: Record
+ * @text: Message
+ * @ctx: Unused
+ *
+ * Prefixes the record's time and "[TAG-LEVEL]", or "[LEVEL]" without a tag.
+ */
+void nlmon_log_default_sink(const struct nlmon_log_record *rec, const char *text, void *ctx);
+
+/**
+ * nlmon_log_start() - Defer formatting to a writer thread
+ * @capacity: Ring size in records, rounded up to a power of two, 0 for
+ *            NLMON_LOG_RING_DEFAULT
+ *
+ * Returns: 0 on success, -EALREADY if running, negative errno otherwise
+ */
+int nlmon_log_start(unsigned int capacity);
+
+/**
+ * nlmon_log_stop() - Deliver what is queued and log synchronously again
+ *
+ * Threads still logging must have stopped, the ring is freed.
+ */
+void nlmon_log_stop(void);
+
+/**
+ * nlmon_log_get_stats() - Read ring statistics
+ * @stats: Filled in, zero while not running
+ */
+void nlmon_log_get_stats(struct nlmon_log_stats *stats);
+
+/**
+ * nlmon_log_submit() - Record a message, used by NLMON_LOG()
+ * @site: Static site descriptor
+ * @nargs: Number of @args, at most NLMON_LOG_MAX_ARGS
+ * @args: Raw argument values
+ *
+ * Never blocks: a record that does not fit in the ring is counted and
+ * dropped.
+ */
+void nlmon_log_submit(const struct nlmon_log_site *site, unsigned int nargs,
+                      const uint64_t *args);
+
+/**
+ * nlmon_log_format() - Format a record
+ * @rec: Record
+ * @buf: Output
+ * @len: Size of @buf
+ *
+ * Supports the d, i, u, o, x, X, c, e, f, g, a, s, p and % conversions
+ * with flags, width and precision, but not '*'.
+ *
+ * Returns: Length of the message, which is truncated to @len - 1
+ */
+int nlmon_log_format(const struct nlmon_log_record *rec, char *buf, size_t len);
+
+/**
+ * nlmon_log_level_name() - Name of a level
+ * @level: NLMON_LOG_* level
+ *
+ * Returns: Static string
+ */
+const char *nlmon_log_level_name(unsigned int level);
+
+/* Raw value of an argument */
+static inline uint64_t nlmon_log_arg_int(int64_t v)
+{
+	return (uint64_t)v;
+}
+
+static inline uint64_t nlmon_log_arg_double(double v)
+{
+	union { double d; uint64_t u; } bits = { .d = v };
+
+	return bits.u;
+}
+
+static inline uint64_t nlmon_log_arg_ptr(const void *p)
+{
+	return (uint64_t)(uintptr_t)p;
+}
+
+#define NLMON_LOG_ARG(x) _Generic((x) + 0,                                      \
+	float: nlmon_log_arg_double,                                            \
+	double: nlmon_log_arg_double,                                           \
+	char *: nlmon_log_arg_ptr,                                              \
+	const char *: nlmon_log_arg_ptr,                                        \
+	void *: nlmon_log_arg_ptr,                                              \
+	const void *: nlmon_log_arg_ptr,                                        \
+	default: nlmon_log_arg_int)(x)
+
+/* Argument list expansion, up to NLMON_LOG_MAX_ARGS */
+#define NLMON_LOG_NARGS(...) NLMON_LOG_NARGS_(_, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define NLMON_LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+#define NLMON_LOG_CAT(a, b) NLMON_LOG_CAT_(a, b)
+#define NLMON_LOG_CAT_(a, b) a##b
+#define NLMON_LOG_A0(...)
+#define NLMON_LOG_A1(a) , NLMON_LOG_ARG(a)
+#define NLMON_LOG_A2(a, ...) , NLMON_LOG_ARG(a) NLMON_LOG_A1(__VA_ARGS__)
+#define NLMON_LOG_A3(a, ...) , NLMON_LOG_ARG(a) NLMON_LOG_A2(__VA_ARGS__)
+#define NLMON_LOG_A4(a, ...) , NLMON_LOG_ARG(a) NLMON_LOG_A3(__VA_ARGS__)
+#define NLMON_LOG_A5(a, ...) , NLMON_LOG_ARG(a) NLMON_LOG_A4(__VA_ARGS__)
+#define NLMON_LOG_A6(a, ...) , NLMON_LOG_ARG(a) NLMON_LOG_A5(__VA_ARGS__)
+#define NLMON_LOG_A7(a, ...) , NLMON_LOG_ARG(a) NLMON_LOG_A6(__VA_ARGS__)
+#define NLMON_LOG_A8(a, ...) , NLMON_LOG_ARG(a) NLMON_LOG_A7(__VA_ARGS__)
+#define NLMON_LOG_ARGS(...) \
+	NLMON_LOG_CAT(NLMON_LOG_A, NLMON_LOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+/* Log through a site formatted by @render */
+#define NLMON_LOG_RENDER(lvl, tag, render, ...) do {                            \
+	static const struct nlmon_log_site nlmon_log_site_ = {                  \
+		NULL, (tag), (lvl), (render) };                                 \
+	const uint64_t nlmon_log_args_[] = { 0 NLMON_LOG_ARGS(__VA_ARGS__) };   \
+	nlmon_log_submit(&nlmon_log_site_, NLMON_LOG_NARGS(__VA_ARGS__),        \
+	                 nlmon_log_args_ + 1);                                  \
+} while (0)
+
+/* Log @fmt with its arguments */
+#define NLMON_LOG(lvl, tag, fmt, ...) do {                                      \
+	static const struct nlmon_log_site nlmon_log_site_ = {                  \
+		(fmt), (tag), (lvl), NULL };                                    \
+	const uint64_t nlmon_log_args_[] = { 0 NLMON_LOG_ARGS(__VA_ARGS__) };   \
+	nlmon_log_submit(&nlmon_log_site_, NLMON_LOG_NARGS(__VA_ARGS__),        \
+	                 nlmon_log_args_ + 1);                                  \
+} while (0)
+
+#endif /* LOG_RING_H */
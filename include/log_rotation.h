@@ -2,6 +2,10 @@
  *
  * Provides generic log file rotation with size-based and time-based
  * policies, and optional gzip compression of rotated files.
+ *
+ * Writers switch to a file opened ahead of time when they rotate. The
+ * old file is closed, renamed down the chain, compressed and pruned on a
+ * background thread, so a write never waits for a rotation.
  */
 
 #ifndef LOG_ROTATION_H
@@ -43,9 +47,18 @@ struct log_rotation_policy {
 	/* General settings */
 	size_t max_rotations;       /* Maximum number of rotated files to keep */
 	bool compress_rotated;      /* Compress rotated files with gzip */
+	int compress_level;         /* gzip level 1-9, 0 for the default */
+	int compress_threads;       /* Compression threads, 0 for one */
 	bool sync_writes;           /* Sync after each write */
 };
 
+/* Rotation latency statistics */
+struct log_rotation_latency {
+	uint64_t swap_ns_max;       /* Longest file switch in a writer */
+	uint64_t rotation_us_max;   /* Longest switch to chain renamed */
+	uint32_t pending;           /* Rotations the thread has not finished */
+};
+
 /* Log rotator handle (opaque) */
 struct log_rotator;
 
@@ -114,6 +127,15 @@ bool log_rotator_check_rotation(struct log_rotator *rotator);
  */
 bool log_rotator_force_rotation(struct log_rotator *rotator);
 
+/**
+ * log_rotator_wait() - Wait until rotated files are renamed
+ * @rotator: Log rotator handle
+ *
+ * Rotated files have their final names after this returns, compression
+ * may still be running.
+ */
+void log_rotator_wait(struct log_rotator *rotator);
+
 /**
  * log_rotator_get_stats() - Get rotator statistics
  * @rotator: Log rotator handle
@@ -121,6 +143,7 @@ bool log_rotator_force_rotation(struct log_rotator *rotator);
  * @current_file_size: Output for current file size
  * @rotations: Output for number of rotations
  * @last_rotation_time: Output for last rotation timestamp
+ * @latency: Output for rotation latencies (can be NULL)
  *
  * Returns: true on success, false on error
  */
@@ -128,6 +151,7 @@ bool log_rotator_get_stats(struct log_rotator *rotator,
                            uint64_t *bytes_written,
                            uint64_t *current_file_size,
                            uint32_t *rotations,
-                           time_t *last_rotation_time);
+                           time_t *last_rotation_time,
+                           struct log_rotation_latency *latency);
 
 #endif /* LOG_ROTATION_H */
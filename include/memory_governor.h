@@ -0,0 +1,177 @@
+/* memory_governor.h - One memory budget across pools and buffers
+ *
+ * The netlink receive buffers, the storage buffer, the event pools and the
+ * exporter queues each cap their own memory without knowing about the
+ * others. The governor holds one budget for the process and a share of it
+ * per subsystem. Subsystems report what they hold, and as usage nears the
+ * budget the governor asks them, in grades, to give memory back, so that
+ * a small system degrades instead of meeting the OOM killer.
+ *
+ * The level follows the budget's use by the reports, or by the resident
+ * set when that is larger:
+ *
+ *   LOW       shrink pools and caches
+ *   HIGH      restrict buffers to their share
+ *   CRITICAL  shed load: sample, compress, drop
+ *
+ * Subsystems over their share get the level itself, those within it at
+ * most LOW. A level is left only once use has fallen hysteresis_pct below
+ * the threshold that raised it.
+ */
+
+#ifndef MEMORY_GOVERNOR_H
+#define MEMORY_GOVERNOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct nlmon_stats_snapshot;
+
+#define MEMORY_GOVERNOR_MAX_SUBSYSTEMS 16
+
+/* Pressure levels, in increasing order */
+enum memory_pressure {
+	MEMORY_PRESSURE_NONE,
+	MEMORY_PRESSURE_LOW,
+	MEMORY_PRESSURE_HIGH,
+	MEMORY_PRESSURE_CRITICAL,
+};
+
+/* Governor configuration */
+struct memory_governor_config {
+	size_t budget;                  /* Bytes for the whole process */
+	unsigned int low_pct;           /* Budget use LOW starts at (0=70) */
+	unsigned int high_pct;          /* Budget use HIGH starts at (0=85) */
+	unsigned int critical_pct;      /* Budget use CRITICAL starts at (0=95) */
+	unsigned int hysteresis_pct;    /* Fall below a threshold this far to leave it (0=5) */
+	bool count_rss;                 /* Judge by the resident set when it exceeds the reports */
+};
+
+/* Bytes a subsystem holds */
+typedef size_t (*memory_usage_fn)(void *ctx);
+
+/*
+ * Apply a pressure level: bring usage to @target bytes or below, 0 when
+ * no longer restricted. Called on the thread running memory_governor_check()
+ * when either changes, and must not call back into the governor.
+ */
+typedef void (*memory_respond_fn)(void *ctx, enum memory_pressure level, size_t target);
+
+/* Subsystem statistics */
+struct memory_subsystem_stats {
+	const char *name;
+	size_t usage;                   /* Bytes at the last check */
+	size_t share;                   /* Bytes of the budget */
+	size_t target;                  /* Last target, 0 for none */
+	enum memory_pressure level;     /* Last level told */
+	uint64_t responses;             /* Times told a new level or target */
+};
+
+/* Governor statistics */
+struct memory_governor_stats {
+	size_t budget;
+	size_t usage;                   /* Sum of the reports */
+	size_t rss;                     /* Resident set, 0 unless count_rss */
+	enum memory_pressure level;
+	enum memory_pressure peak_level;
+	uint64_t checks;
+	uint64_t escalations;           /* Checks that raised the level */
+	size_t num_subsystems;
+};
+
+/* Memory governor (opaque) */
+struct memory_governor;
+
+/**
+ * memory_governor_create() - Create a governor
+ * @config: Governor configuration, with a budget
+ *
+ * Returns: Governor or NULL on invalid configuration or allocation failure
+ */
+struct memory_governor *memory_governor_create(const struct memory_governor_config *config);
+
+/**
+ * memory_governor_destroy() - Destroy a governor
+ * @gov: Governor (can be NULL)
+ *
+ * Subsystems keep whatever limits they were last told.
+ */
+void memory_governor_destroy(struct memory_governor *gov);
+
+/**
+ * memory_governor_add() - Add a subsystem
+ * @gov: Governor
+ * @name: Name, a string that outlives the governor
+ * @share_pct: Percentage of the budget the subsystem may keep under pressure
+ * @usage: Usage report
+ * @respond: Pressure response (NULL to only account)
+ * @ctx: Argument of both, the subsystem's handle
+ *
+ * Returns: 0 on success, -1 when full or the shares would exceed 100%
+ */
+int memory_governor_add(struct memory_governor *gov, const char *name, unsigned int share_pct,
+                        memory_usage_fn usage, memory_respond_fn respond, void *ctx);
+
+/**
+ * memory_governor_check() - Collect the reports and apply the pressure
+ * @gov: Governor
+ *
+ * Returns: Pressure level
+ */
+enum memory_pressure memory_governor_check(struct memory_governor *gov);
+
+/**
+ * memory_governor_notify() - Check on each stats bus snapshot
+ * @snapshot: Published snapshot, unused
+ * @ctx: Governor
+ *
+ * A stats_bus_notify_fn, so the bus thread drives the governor:
+ * stats_bus_subscribe(bus, memory_governor_notify, gov).
+ */
+void memory_governor_notify(const struct nlmon_stats_snapshot *snapshot, void *ctx);
+
+/**
+ * memory_governor_level() - Pressure level of the last check
+ * @gov: Governor
+ *
+ * Lock free, for hot paths that degrade on their own.
+ *
+ * Returns: Pressure level
+ */
+enum memory_pressure memory_governor_level(struct memory_governor *gov);
+
+/**
+ * memory_governor_get_stats() - Get governor statistics
+ * @gov: Governor
+ * @stats: Output statistics
+ */
+void memory_governor_get_stats(struct memory_governor *gov, struct memory_governor_stats *stats);
+
+/**
+ * memory_governor_get_subsystems() - Get per subsystem statistics
+ * @gov: Governor
+ * @subsystems: Output array
+ * @max: Size of @subsystems
+ *
+ * Returns: Number of entries filled in
+ */
+size_t memory_governor_get_subsystems(struct memory_governor *gov,
+                                      struct memory_subsystem_stats *subsystems, size_t max);
+
+/**
+ * memory_governor_process_rss() - Resident set of the process
+ *
+ * Returns: Bytes resident, 0 if unknown
+ */
+size_t memory_governor_process_rss(void);
+
+/**
+ * memory_pressure_name() - Name of a pressure level
+ * @level: Pressure level
+ *
+ * Returns: "none", "low", "high" or "critical"
+ */
+const char *memory_pressure_name(enum memory_pressure level);
+
+#endif /* MEMORY_GOVERNOR_H */
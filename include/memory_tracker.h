@@ -1,6 +1,9 @@
 /* memory_tracker.h - Memory usage tracking and reporting
  *
- * Provides memory usage statistics and tracking.
+ * Provides memory usage statistics and tracking. With tracking enabled,
+ * live allocations are kept by pointer and aggregated by the call site
+ * and subsystem that made them. Sampling tracks only some allocations,
+ * weighted by size, and extrapolates the rest.
  */
 
 #ifndef MEMORY_TRACKER_H
@@ -21,8 +24,34 @@ struct memory_stats {
 	size_t peak_usage;       /* Peak tracked usage (bytes) */
 	unsigned long alloc_count;   /* Number of allocations */
 	unsigned long free_count;    /* Number of frees */
+	unsigned long tracked;       /* Live allocations being tracked */
+	size_t sample_interval;      /* 0 when every allocation is tracked */
 };
 
+/* Live and total allocations of a call site or a subsystem, estimates
+ * when sampling */
+struct memory_site_stats {
+	const char *subsystem;       /* "unknown" if none was given */
+	const char *site;            /* NULL for a subsystem total */
+	size_t live_bytes;
+	size_t live_count;
+	size_t total_bytes;
+	size_t total_count;
+};
+
+#define MEMORY_TRACKER_STR_(x) #x
+#define MEMORY_TRACKER_STR(x) MEMORY_TRACKER_STR_(x)
+
+/* Call site of the code using it, "file.c:123" */
+#define MEMORY_TRACKER_SITE __FILE__ ":" MEMORY_TRACKER_STR(__LINE__)
+
+/* Track an allocation as made here by a subsystem */
+#define memory_tracker_alloc_here(tracker, size, ptr, subsystem) \
+	memory_tracker_alloc_at(tracker, size, ptr, subsystem, MEMORY_TRACKER_SITE)
+
+/* Most call sites told apart, the unknown one included */
+#define MEMORY_TRACKER_MAX_SITES 256
+
 /* Memory tracker structure (opaque) */
 struct memory_tracker;
 
@@ -48,6 +77,20 @@ void memory_tracker_destroy(struct memory_tracker *tracker);
  */
 void memory_tracker_alloc(struct memory_tracker *tracker, size_t size, void *ptr);
 
+/**
+ * memory_tracker_alloc_at() - Track memory allocation by call site
+ * @tracker: Memory tracker
+ * @size: Size of allocation
+ * @ptr: Pointer to allocated memory
+ * @subsystem: Subsystem name, a string that outlives the tracker, or NULL
+ * @site: Call site, a string constant such as MEMORY_TRACKER_SITE, or NULL
+ *
+ * Sites are told apart by the address of @site, at most
+ * MEMORY_TRACKER_MAX_SITES of them; further ones count as unknown.
+ */
+void memory_tracker_alloc_at(struct memory_tracker *tracker, size_t size, void *ptr,
+                             const char *subsystem, const char *site);
+
 /**
  * memory_tracker_free() - Track memory free
  * @tracker: Memory tracker
@@ -55,6 +98,43 @@ void memory_tracker_alloc(struct memory_tracker *tracker, size_t size, void *ptr
  */
 void memory_tracker_free(struct memory_tracker *tracker, void *ptr);
 
+/**
+ * memory_tracker_set_sampling() - Track only a sample of allocations
+ * @tracker: Memory tracker
+ * @interval: Mean bytes allocated between tracked allocations, 0 to
+ *            track every allocation
+ *
+ * An allocation of size bytes is tracked with probability
+ * size / @interval and then stands for @interval bytes, so usage and
+ * site figures stay unbiased estimates. Allocations of @interval bytes
+ * or more are always tracked. With 64 byte objects, an interval of 64KB
+ * tracks about 1 in 1024 of them.
+ */
+void memory_tracker_set_sampling(struct memory_tracker *tracker, size_t interval);
+
+/**
+ * memory_tracker_get_sites() - Get per call site statistics
+ * @tracker: Memory tracker
+ * @sites: Output array
+ * @max_sites: Size of @sites
+ *
+ * Returns: Number of sites written, largest live usage first
+ */
+int memory_tracker_get_sites(struct memory_tracker *tracker,
+                             struct memory_site_stats *sites, int max_sites);
+
+/**
+ * memory_tracker_get_subsystems() - Get per subsystem statistics
+ * @tracker: Memory tracker
+ * @subsystems: Output array, site is NULL in each
+ * @max_subsystems: Size of @subsystems
+ *
+ * Returns: Number of subsystems written, largest live usage first
+ */
+int memory_tracker_get_subsystems(struct memory_tracker *tracker,
+                                  struct memory_site_stats *subsystems,
+                                  int max_subsystems);
+
 /**
  * memory_tracker_get_stats() - Get memory statistics
  * @tracker: Memory tracker
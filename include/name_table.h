@@ -0,0 +1,65 @@
+/* name_table.h - Constant-time lookups between IDs and their names
+ *
+ * Wraps a static array of ID/name pairs, such as the WMI command or QCA
+ * vendor subcommand names, with an index for both directions. IDs that
+ * span a small range are looked up in a dense array, others through an
+ * open-addressed hash, and names through a hash of their bytes, so
+ * neither direction walks the entries or compares more than one name.
+ *
+ * The index is built on the first lookup, by whichever thread gets there
+ * first, and lives as long as the process. Lookups are safe from any
+ * number of threads. When memory for the index cannot be had the table
+ * is searched linearly instead.
+ */
+
+#ifndef NAME_TABLE_H
+#define NAME_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/* ID and its name */
+struct name_table_entry {
+	uint32_t id;
+	const char *name;
+};
+
+/* Index of a table (opaque) */
+struct name_index;
+
+/* Table of entries, defined with NAME_TABLE_INIT() */
+struct name_table {
+	const struct name_table_entry *entries;
+	size_t count;
+	_Atomic(struct name_index *) index;
+};
+
+/* Initializer for a table over a static array of entries. An ID listed
+ * more than once takes the first name, every name can be looked up. */
+#define NAME_TABLE_INIT(array) \
+	{ .entries = (array), .count = sizeof(array) / sizeof((array)[0]), .index = NULL }
+
+/**
+ * name_table_name() - Look up the name of an ID
+ * @table: Table
+ * @id: ID
+ *
+ * Returns: Name or NULL if the ID is not in the table
+ */
+const char *name_table_name(struct name_table *table, uint32_t id);
+
+/**
+ * name_table_find() - Look up the ID of a name
+ * @table: Table
+ * @name: Name, not necessarily NUL-terminated
+ * @len: Length of @name
+ * @id: Output for the ID
+ *
+ * Returns: true if the name is in the table
+ */
+bool name_table_find(struct name_table *table, const char *name, size_t len,
+                     uint32_t *id);
+
+#endif /* NAME_TABLE_H */
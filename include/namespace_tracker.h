@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+struct nlmsghdr;
+
 #define NAMESPACE_NAME_MAX 256
 
 /* Network namespace information */
@@ -25,7 +27,8 @@ int namespace_tracker_detect_from_msg(struct namespace_tracker *tracker,
                                       struct nlmsghdr *nlh,
                                       struct netns_info *nsinfo);
 
-/* Get namespace info by interface index */
+/* Get namespace info by interface index, the current namespace for
+ * interfaces not seen in RTM_NEWLINK */
 int namespace_tracker_get_by_ifindex(struct namespace_tracker *tracker,
                                      int ifindex,
                                      struct netns_info *nsinfo);
@@ -44,9 +47,39 @@ int namespace_tracker_matches_filter(struct namespace_tracker *tracker,
                                      const struct netns_info *nsinfo,
                                      const char *filter);
 
-/* Update namespace cache */
+/* Called for each cached namespace with a path that opens it, the bind
+ * mount of a named namespace or /proc/<pid>/ns/net. The path may have
+ * come to name another namespace since, callers opening it should check
+ * the inode. */
+typedef void (*namespace_tracker_foreach_fn)(const struct netns_info *nsinfo,
+                                             const char *path, void *arg);
+
+/* Walk the cached namespaces, catching up with events first. Returns the
+ * number of namespaces passed to fn, -1 on error. fn must not call back
+ * into the tracker. */
+int namespace_tracker_foreach(struct namespace_tracker *tracker,
+                              namespace_tracker_foreach_fn fn, void *arg);
+
+/* Update namespace cache: full rescan of /var/run/netns and /proc. Lookups
+ * run it themselves every reconcile interval, or sooner after netns events */
 void namespace_tracker_update_cache(struct namespace_tracker *tracker);
 
+/* Apply RTM_NEWLINK/RTM_DELLINK to the interface cache and note
+ * RTM_NEWNSID/RTM_DELNSID. Returns 1 if a cache changed, 0 if the message
+ * was not for them, -1 on error */
+int namespace_tracker_handle_msg(struct namespace_tracker *tracker,
+                                 const struct nlmsghdr *nlh);
+
+/* File descriptor readable when /var/run/netns changes, -1 without one */
+int namespace_tracker_get_fd(struct namespace_tracker *tracker);
+
+/* Apply pending /var/run/netns changes, on the next lookup */
+void namespace_tracker_process_events(struct namespace_tracker *tracker);
+
+/* Seconds between full rescans, 0 for the default of 60 */
+void namespace_tracker_set_reconcile_interval(struct namespace_tracker *tracker,
+                                              unsigned int seconds);
+
 /* Cleanup */
 void namespace_tracker_destroy(struct namespace_tracker *tracker);
 
@@ -46,6 +46,25 @@ struct nlmon_sock_diag {
 	char dst_addr[64];
 };
 
+/* Protocols of a context, in dispatch order */
+#define NLMON_MP_PROTOCOLS        3
+
+/* Default fairness budget: datagrams per protocol and unit of weight per dispatch */
+#define NLMON_MP_DEFAULT_BUDGET   64
+#define NLMON_MP_BATCH            16     /* Datagrams per recvmmsg() */
+
+/* Per-protocol dispatch statistics */
+struct nlmon_multi_protocol_stats {
+	uint64_t datagrams;            /* Datagrams received */
+	uint64_t messages;             /* Netlink messages processed */
+	uint64_t drains;               /* Dispatches that read the socket */
+	uint64_t drain_ns;             /* Time spent reading and processing */
+	uint64_t budget_exhausted;     /* Dispatches that left data behind */
+	uint64_t errors;               /* Receive errors */
+	uint32_t backlog;              /* Bytes queued on the socket at last look */
+	unsigned int weight;
+};
+
 /* Multi-protocol netlink context */
 struct nlmon_multi_protocol_ctx {
 	int route_sock;
@@ -60,6 +79,14 @@ struct nlmon_multi_protocol_ctx {
 	/* Callback for events */
 	void (*event_callback)(nlmon_event_type_t type, void *data, void *user_data);
 	void *user_data;
+	
+	/* Edge-triggered epoll set of the enabled sockets (see nlmon_multi_protocol_dispatch) */
+	int epoll_fd;
+	unsigned int budget;
+	struct nlmon_multi_protocol_stats stats[NLMON_MP_PROTOCOLS];
+	
+	/* Receive buffers of one batch, allocated on first use */
+	char *recv_bufs;
 };
 
 /* Initialize multi-protocol support */
@@ -80,6 +107,30 @@ int nlmon_multi_protocol_get_fd(struct nlmon_multi_protocol_ctx *ctx, nlmon_prot
 /* Process messages from a specific protocol */
 int nlmon_multi_protocol_process(struct nlmon_multi_protocol_ctx *ctx, nlmon_protocol_t proto);
 
+/* Single fd for event loop integration, readable while any enabled socket has data */
+int nlmon_multi_protocol_get_epoll_fd(struct nlmon_multi_protocol_ctx *ctx);
+
+/*
+ * Drain every ready socket, interleaving batches across protocols
+ *
+ * Each protocol reads at most weight * budget datagrams per call. A socket
+ * left with data is re-armed, so the epoll fd stays readable and the rest of
+ * the event loop runs before the next call. Returns the number of messages
+ * processed, or -1 on error.
+ */
+int nlmon_multi_protocol_dispatch(struct nlmon_multi_protocol_ctx *ctx);
+
+/* Share of the budget a protocol gets per dispatch (default 1, 0 is refused) */
+int nlmon_multi_protocol_set_weight(struct nlmon_multi_protocol_ctx *ctx, nlmon_protocol_t proto,
+                                    unsigned int weight);
+
+/* Datagrams per unit of weight and dispatch (default NLMON_MP_DEFAULT_BUDGET) */
+int nlmon_multi_protocol_set_budget(struct nlmon_multi_protocol_ctx *ctx, unsigned int budget);
+
+/* Dispatch statistics of a protocol, the backlog is sampled now */
+int nlmon_multi_protocol_get_stats(struct nlmon_multi_protocol_ctx *ctx, nlmon_protocol_t proto,
+                                   struct nlmon_multi_protocol_stats *stats);
+
 /* Parse NETLINK_GENERIC messages */
 int nlmon_parse_generic_msg(struct nlmsghdr *nlh, struct nlmon_generic_msg *msg);
 
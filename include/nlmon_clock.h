@@ -0,0 +1,159 @@
+/* nlmon_clock.h - Time service shared by all subsystems
+ *
+ * Three clocks for three kinds of users:
+ *
+ *   coarse   Seconds and milliseconds for timeouts, retention cutoffs and
+ *            alert bookkeeping. A ticker thread stores the time in a page
+ *            every interval, so reading it is a load and not a system
+ *            call or a trip through the vDSO. Without a ticker the readers
+ *            fall back to the kernel's CLOCK_*_COARSE clocks.
+ *   precise  Nanoseconds of CLOCK_MONOTONIC, for latencies.
+ *   cycles   The TSC on x86, the virtual counter on arm64, for profiling.
+ *            Converted to nanoseconds at a rate calibrated once.
+ *
+ * An event takes its timestamp when its netlink message is received
+ * (nlmon_nl_recv_timestamp()) and keeps it through every later stage.
+ */
+
+#ifndef NLMON_CLOCK_H
+#define NLMON_CLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#define NLMON_CLOCK_DEFAULT_INTERVAL_MS 1
+
+/* The clock page, written by the ticker only */
+struct nlmon_clock_page {
+	_Atomic uint64_t realtime_ns;   /* 0 while no ticker runs */
+	_Atomic uint64_t monotonic_ns;
+	_Atomic uint64_t ticks;         /* Updates so far */
+};
+
+extern struct nlmon_clock_page nlmon_clock_page;
+
+/* Read a kernel clock in nanoseconds */
+static inline uint64_t nlmon_clock_read(clockid_t id)
+{
+	struct timespec ts;
+	
+	clock_gettime(id, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * nlmon_clock_realtime_ns() - Coarse wall clock
+ *
+ * Returns: Nanoseconds since the epoch, as of the last tick
+ */
+static inline uint64_t nlmon_clock_realtime_ns(void)
+{
+	uint64_t ns = atomic_load_explicit(&nlmon_clock_page.realtime_ns, memory_order_relaxed);
+	
+	return ns ? ns : nlmon_clock_read(CLOCK_REALTIME_COARSE);
+}
+
+/**
+ * nlmon_clock_monotonic_ns() - Coarse monotonic clock
+ *
+ * Returns: Nanoseconds of CLOCK_MONOTONIC, as of the last tick
+ */
+static inline uint64_t nlmon_clock_monotonic_ns(void)
+{
+	uint64_t ns = atomic_load_explicit(&nlmon_clock_page.monotonic_ns, memory_order_relaxed);
+	
+	return ns ? ns : nlmon_clock_read(CLOCK_MONOTONIC_COARSE);
+}
+
+/* Coarse wall clock in seconds, the replacement for time(NULL) */
+static inline time_t nlmon_clock_seconds(void)
+{
+	return (time_t)(nlmon_clock_realtime_ns() / 1000000000ULL);
+}
+
+/* Coarse wall clock in milliseconds */
+static inline uint64_t nlmon_clock_ms(void)
+{
+	return nlmon_clock_realtime_ns() / 1000000ULL;
+}
+
+/* Coarse monotonic clock in milliseconds, for durations and deadlines */
+static inline uint64_t nlmon_clock_monotonic_ms(void)
+{
+	return nlmon_clock_monotonic_ns() / 1000000ULL;
+}
+
+/* Precise CLOCK_MONOTONIC in nanoseconds */
+static inline uint64_t nlmon_clock_precise_ns(void)
+{
+	return nlmon_clock_read(CLOCK_MONOTONIC);
+}
+
+/**
+ * nlmon_clock_cycles() - Read the cycle counter
+ *
+ * The TSC on x86, the virtual counter on arm64, nanoseconds of
+ * CLOCK_MONOTONIC elsewhere. Only differences mean anything.
+ *
+ * Returns: Cycle count
+ */
+static inline uint64_t nlmon_clock_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+	uint64_t cycles;
+	
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(cycles));
+	return cycles;
+#else
+	return nlmon_clock_precise_ns();
+#endif
+}
+
+/**
+ * nlmon_clock_ns_per_cycle() - Rate of the cycle counter
+ *
+ * Calibrated against CLOCK_MONOTONIC on the first call, which may take
+ * a few milliseconds. Thread safe.
+ *
+ * Returns: Nanoseconds per cycle
+ */
+double nlmon_clock_ns_per_cycle(void);
+
+/* Convert a difference of nlmon_clock_cycles() to nanoseconds */
+static inline uint64_t nlmon_clock_cycles_to_ns(uint64_t cycles)
+{
+	return (uint64_t)((double)cycles * nlmon_clock_ns_per_cycle());
+}
+
+/**
+ * nlmon_clock_update() - Store the current time in the clock page
+ *
+ * The ticker calls this every interval. Without a ticker it may be called
+ * from a loop that wakes up anyway, but once called the page is what
+ * readers see, so it must keep being called.
+ */
+void nlmon_clock_update(void);
+
+/**
+ * nlmon_clock_start() - Start the ticker thread
+ * @interval_ms: Update interval, 0 for NLMON_CLOCK_DEFAULT_INTERVAL_MS
+ *
+ * Returns: 0 on success, -1 if the thread could not be started
+ */
+int nlmon_clock_start(unsigned int interval_ms);
+
+/**
+ * nlmon_clock_stop() - Stop the ticker thread
+ *
+ * Readers go back to the kernel's coarse clocks.
+ */
+void nlmon_clock_stop(void);
+
+/* Whether a ticker keeps the page up to date */
+bool nlmon_clock_running(void);
+
+#endif /* NLMON_CLOCK_H */
@@ -18,6 +18,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <pthread.h>
 
 /* Maximum string lengths */
@@ -48,6 +49,24 @@ struct nlmon_core_config {
 	int max_events;               /* Maximum events in memory buffer */
 	int rate_limit;               /* Events per second limit */
 	int worker_threads;           /* Number of worker threads */
+	
+	/* Further rate limit levels, events per second (0=none) */
+	int global_rate_limit;        /* Over all events */
+	int interface_rate_limit;     /* Per interface */
+	int genl_family_rate_limit;   /* Per generic netlink family */
+	int rate_limit_keys;          /* Interfaces and families tracked at once */
+	
+	/* Memory budget shared by pools and buffers, see memory_governor.h (0=none) */
+	size_t memory_budget;         /* Bytes */
+	
+	/* Stall watchdog of the pipeline threads, see pipeline_watchdog.h */
+	unsigned int stall_ms;        /* Time without progress that is a stall (0=off) */
+	bool stall_restart;           /* Restart stalled stages that support it */
+	
+	/* Huge pages for large rings, pools and buffers, see huge_alloc.h */
+	int hugepages;                /* enum huge_alloc_mode (0=off) */
+	size_t hugepage_min_size;     /* Smallest array backed in bytes (0=2MB) */
+	bool hugepage_prefault;       /* Fault backed arrays in when allocated */
 };
 
 /* Monitoring configuration */
@@ -67,6 +86,14 @@ struct nlmon_monitoring_config {
 	bool namespaces_enabled;
 };
 
+/* nlmon device capture configuration */
+struct nlmon_capture_config {
+	bool mmap_ring;               /* Use a TPACKET_V3 memory-mapped RX ring */
+	size_t ring_block_size;       /* Ring block size in bytes (page multiple) */
+	int ring_block_count;         /* Number of blocks in the ring */
+	int ring_block_timeout_ms;    /* Block retire timeout in milliseconds */
+};
+
 /* Netlink protocol configuration */
 struct nlmon_netlink_protocols_config {
 	bool route;                   /* Enable NETLINK_ROUTE */
@@ -79,6 +106,8 @@ struct nlmon_netlink_protocols_config {
 struct nlmon_netlink_buffer_config {
 	size_t receive;               /* Receive buffer size in bytes */
 	size_t send;                  /* Send buffer size in bytes */
+	bool autotune;                /* Grow/shrink receive buffer with load */
+	size_t receive_max;           /* Autotuning ceiling in bytes */
 };
 
 /* Netlink cache configuration */
@@ -103,6 +132,26 @@ struct nlmon_netlink_genl_config {
 	char families[NLMON_MAX_GENL_FAMILIES][NLMON_MAX_NAME];
 };
 
+/* Conntrack events received over NETLINK_NETFILTER, narrowed in the kernel */
+struct nlmon_netlink_conntrack_config {
+	bool events_new;              /* New connections */
+	bool events_update;           /* State changes of connections */
+	bool events_destroy;          /* Connections torn down */
+	int l3proto;                  /* AF_INET or AF_INET6, 0 for any */
+	int l4proto;                  /* IP protocol number, 0 for any */
+	int zone;                     /* Conntrack zone, -1 for any */
+	uint32_t mark;                /* Wanted value of mark & mark_mask */
+	uint32_t mark_mask;           /* 0 to ignore the mark */
+};
+
+/* Fair dispatch of the legacy multi-protocol sockets */
+struct nlmon_netlink_dispatch_config {
+	unsigned int budget;          /* Datagrams per unit of weight and dispatch */
+	unsigned int route_weight;
+	unsigned int generic_weight;
+	unsigned int sock_diag_weight;
+};
+
 /* Netlink configuration */
 struct nlmon_netlink_config {
 	bool use_libnl;               /* Use libnl-based implementation (default: true) */
@@ -111,6 +160,8 @@ struct nlmon_netlink_config {
 	struct nlmon_netlink_cache_config caching;
 	struct nlmon_netlink_mcast_config multicast_groups;
 	struct nlmon_netlink_genl_config generic_families;
+	struct nlmon_netlink_conntrack_config conntrack;
+	struct nlmon_netlink_dispatch_config dispatch;
 };
 
 /* Filter configuration */
@@ -175,6 +226,17 @@ struct nlmon_metrics_config {
 	char path[NLMON_MAX_PATH];
 };
 
+/* Thread placement, each field is a CPU list such as "0-3,8" ("" = any) */
+#define NLMON_MAX_CPULIST 64
+struct nlmon_threads_config {
+	char dispatcher_cpus[NLMON_MAX_CPULIST];  /* Event dispatcher */
+	char worker_cpus[NLMON_MAX_CPULIST];      /* Event workers, one CPU each */
+	char web_cpus[NLMON_MAX_CPULIST];         /* WebSocket server */
+	char metrics_cpus[NLMON_MAX_CPULIST];     /* Prometheus HTTP server */
+	char retention_cpus[NLMON_MAX_CPULIST];   /* Storage retention cleanup */
+	char wmi_cpus[NLMON_MAX_CPULIST];         /* WMI log reader */
+};
+
 /* Plugin configuration */
 struct nlmon_plugins_config {
 	char directory[NLMON_MAX_PATH];
@@ -233,6 +295,13 @@ struct nlmon_hook_config {
 	uint32_t timeout_ms;
 	bool enabled;
 	bool async;
+	bool persistent;
+	uint32_t max_concurrent;
+	uint32_t batch_count;
+	uint32_t batch_interval_ms;
+	uint32_t queue_size;
+	char overflow[16];            /* "drop", "coalesce" or "sample" */
+	uint32_t sample_rate;
 };
 
 /* Integration configuration */
@@ -257,6 +326,7 @@ struct nlmon_config {
 	struct nlmon_core_config core;
 	struct nlmon_monitoring_config monitoring;
 	struct nlmon_netlink_config netlink;
+	struct nlmon_capture_config capture;
 	
 	int filter_count;
 	struct nlmon_filter_config filters[NLMON_MAX_FILTERS];
@@ -265,6 +335,7 @@ struct nlmon_config {
 	struct nlmon_cli_config cli;
 	struct nlmon_web_config web;
 	struct nlmon_metrics_config metrics;
+	struct nlmon_threads_config threads;
 	struct nlmon_plugins_config plugins;
 	
 	int alert_count;
@@ -272,18 +343,45 @@ struct nlmon_config {
 	
 	struct nlmon_integration_config integration;
 	
+	/* State derived by the prepare hook, such as compiled filters, freed
+	 * with the configuration (see nlmon_config_ctx_set_prepare) */
+	void *prepared;
+	void (*prepared_free)(void *prepared);
+	
 	/* Thread safety */
 	pthread_rwlock_t lock;
 };
 
-/* Configuration context for thread-safe access */
+/* Time taken by the stages of a load or reload, in nanoseconds */
+struct nlmon_config_timing {
+	uint64_t load_ns;             /* Read and parse the file */
+	uint64_t validate_ns;         /* Environment overrides and validation */
+	uint64_t prepare_ns;          /* Prepare hook, such as compiling filters */
+	uint64_t publish_ns;          /* Swap and wait for readers of the old snapshot */
+	uint64_t total_ns;
+	uint64_t reloads;             /* Successful reloads so far */
+};
+
+/* Configuration context for thread-safe access
+ *
+ * current is an immutable snapshot. Readers use it inside a read side
+ * section without taking a lock or copying it, and a reload publishes a
+ * new snapshot with one pointer exchange. The replaced snapshot is freed
+ * once every section that might have seen it has ended. Sections are
+ * counted in two alternating counters, like the filter manager's.
+ */
 struct nlmon_config_ctx {
-	struct nlmon_config *current;
+	_Atomic(struct nlmon_config *) current;
 	struct nlmon_config *pending;
-	pthread_mutex_t swap_mutex;
+	pthread_mutex_t swap_mutex;   /* Serializes reloads */
+	_Atomic unsigned readers[2];  /* Read side sections per epoch */
+	_Atomic unsigned reader_epoch;
+	int (*prepare)(struct nlmon_config *config, void *arg);
+	void *prepare_arg;
 	int watch_fd;                 /* inotify file descriptor */
 	int watch_wd;                 /* inotify watch descriptor */
 	bool reload_requested;
+	struct nlmon_config_timing timing; /* Last load or reload, under swap_mutex */
 };
 
 /* Configuration API */
@@ -327,6 +425,29 @@ int nlmon_config_validate(const struct nlmon_config *config);
  */
 void nlmon_config_apply_env(struct nlmon_config *config);
 
+/* Lock-free snapshot access */
+
+/**
+ * nlmon_config_read_begin - Enter a read side section
+ * @ctx: Configuration context
+ * @token: Output, passed to nlmon_config_read_end()
+ *
+ * The snapshot stays valid until nlmon_config_read_end() and must not be
+ * modified. Sections are cheap but hold up the freeing of a replaced
+ * snapshot, so keep them short and never block inside one.
+ *
+ * Returns: Current configuration, or NULL if the context has none
+ */
+const struct nlmon_config *nlmon_config_read_begin(struct nlmon_config_ctx *ctx,
+                                                   unsigned *token);
+
+/**
+ * nlmon_config_read_end - Leave a read side section
+ * @ctx: Configuration context
+ * @token: Token from nlmon_config_read_begin()
+ */
+void nlmon_config_read_end(struct nlmon_config_ctx *ctx, unsigned token);
+
 /* Type-safe accessor functions */
 
 /**
@@ -377,6 +498,22 @@ void nlmon_config_get_web(struct nlmon_config_ctx *ctx,
 void nlmon_config_get_netlink(struct nlmon_config_ctx *ctx,
                               struct nlmon_netlink_config *netlink);
 
+/**
+ * nlmon_config_get_capture - Get nlmon device capture configuration (thread-safe)
+ * @ctx: Configuration context
+ * @capture: Output buffer for capture configuration
+ */
+void nlmon_config_get_capture(struct nlmon_config_ctx *ctx,
+                              struct nlmon_capture_config *capture);
+
+/**
+ * nlmon_config_get_threads - Get thread placement configuration (thread-safe)
+ * @ctx: Configuration context
+ * @threads: Output buffer for thread placement configuration
+ */
+void nlmon_config_get_threads(struct nlmon_config_ctx *ctx,
+                              struct nlmon_threads_config *threads);
+
 /**
  * nlmon_config_get_version - Get current configuration version
  * @ctx: Configuration context
@@ -402,14 +539,47 @@ int nlmon_config_ctx_init(struct nlmon_config_ctx *ctx, const char *config_file)
  */
 void nlmon_config_ctx_free(struct nlmon_config_ctx *ctx);
 
+/**
+ * nlmon_config_ctx_set_prepare - Set the hook that prepares new snapshots
+ * @ctx: Configuration context
+ * @prepare: Called with each validated configuration before it is
+ *           published, on the reloading thread. It may set prepared and
+ *           prepared_free. A negative return rejects the configuration.
+ * @arg: Passed to @prepare
+ *
+ * The hook is also run on the current configuration, so set it before
+ * any thread reads the configuration.
+ *
+ * Returns: NLMON_CONFIG_OK on success, error code if the hook failed on
+ *          the current configuration
+ */
+int nlmon_config_ctx_set_prepare(struct nlmon_config_ctx *ctx,
+                                 int (*prepare)(struct nlmon_config *config, void *arg),
+                                 void *arg);
+
 /**
  * nlmon_config_ctx_reload - Reload configuration from file
  * @ctx: Configuration context
  *
+ * Loads, validates and prepares the new configuration without affecting
+ * readers, then publishes it. Readers never wait for a reload; the
+ * calling thread waits for readers of the old snapshot to leave before
+ * freeing it, so call it off the ingestion path.
+ *
  * Returns: NLMON_CONFIG_OK on success, error code otherwise
  */
 int nlmon_config_ctx_reload(struct nlmon_config_ctx *ctx);
 
+/**
+ * nlmon_config_ctx_get_timing - Get the stage times of the last load
+ * @ctx: Configuration context
+ * @timing: Output, of nlmon_config_ctx_init() and the prepare hook run by
+ *          nlmon_config_ctx_set_prepare() until a reload succeeds, then
+ *          of the last successful reload
+ */
+void nlmon_config_ctx_get_timing(struct nlmon_config_ctx *ctx,
+                                 struct nlmon_config_timing *timing);
+
 /**
  * nlmon_config_watch_init - Initialize configuration file watching
  * @ctx: Configuration context
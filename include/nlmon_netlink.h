@@ -13,39 +13,38 @@
 #include <netlink/msg.h>
 #include <netlink/handlers.h>
 
+#include "nlmon_nl_error.h"
+#include "nlmon_nl_resync.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-/* Logging levels for netlink operations */
-enum nlmon_nl_log_level {
-	NLMON_NL_LOG_ERROR = 0,   /* Error messages */
-	NLMON_NL_LOG_WARN = 1,    /* Warning messages */
-	NLMON_NL_LOG_INFO = 2,    /* Informational messages */
-	NLMON_NL_LOG_DEBUG = 3,   /* Debug messages */
-};
-
-/* Set logging level for netlink operations */
-void nlmon_nl_set_log_level(enum nlmon_nl_log_level level);
-
-/* Get current logging level */
-enum nlmon_nl_log_level nlmon_nl_get_log_level(void);
-
-/* Enable/disable message dumping on parse errors */
-void nlmon_nl_set_dump_on_error(int enable);
-
-/* Log netlink error with context */
-void nlmon_nl_log_error(const char *context, int error);
-
-/* Log netlink message details (for debugging) */
-void nlmon_nl_log_message(struct nlmsghdr *nlh, const char *direction);
-
-/* Dump netlink message in hex format */
-void nlmon_nl_dump_message(struct nlmsghdr *nlh, size_t len);
-
 /* Forward declarations */
 struct nlmon_event;
 struct nlmon_netlink_config;
+struct nlmon_nl_rx_thread;
+struct nlmon_nl_limits;
+struct nlmon_nl_delta;
+struct nlmon_nl_manager;
+struct event_processor;
+struct io_recv;
+struct sock_filter;
+struct nlmon_nl_msgpool;
+
+/* Receive buffers of the manager's own pool (see nlmon_nl_set_msgpool) */
+#define NLMON_NL_RX_POOL_BUFFERS 8
+#define NLMON_NL_RX_BUFFER_SIZE 16384
+
+/**
+ * Protocol socket received through an io_recv (see nlmon_nl_attach_io_recv)
+ */
+struct nlmon_nl_recv_slot {
+	struct nlmon_nl_manager *mgr;
+	int protocol;
+	int source;                      /* io_recv source, -1 when not attached */
+	int lane;                        /* Producer lane, -1 to deliver on the receiving thread */
+};
 
 /**
  * nlmon netlink manager structure
@@ -85,6 +84,52 @@ struct nlmon_nl_manager {
 	struct nl_cache *link_cache;
 	struct nl_cache *addr_cache;
 	struct nl_cache *route_cache;
+	
+	/* Per-protocol receive threads (see nlmon_nl_start_rx_threads) */
+	struct nlmon_nl_rx_thread *rx_threads;
+	int rx_thread_count;
+	struct event_processor *rx_processor;
+	int rx_handler_id;
+	void (*rx_user_callback)(struct nlmon_event *evt, void *user_data);
+	void *rx_user_data;
+	
+	/* io_uring receive of the protocol sockets, indexed like filters[] */
+	struct io_recv *rx_recv;
+	struct nlmon_nl_recv_slot rx_recv_slots[4];
+	
+	/* Overrun recovery (see nlmon_nl_enable_resync) */
+	struct nlmon_nl_state *state;            /* Last known NETLINK_ROUTE state */
+	struct nlmon_nl_limits *limits;          /* Optional socket buffer accounting */
+	struct nlmon_nl_delta *delta;            /* Optional suppression of unchanged updates */
+	struct nlmon_nl_resync_stats resync_stats;
+	
+	/* Kernel socket prefilters, one per protocol (see nlmon_nl_set_filter) */
+	struct sock_filter *filters[4];
+	unsigned short filter_lens[4];
+	
+	/* Conntrack narrowing (see nlmon_nl_set_ct_filter), runs before the
+	 * NETLINK_NETFILTER prefilter */
+	struct sock_filter *ct_prog;
+	unsigned short ct_prog_len;
+	uint32_t ct_events;                      /* NLMON_CT_EVENT_* groups joined */
+	
+	/* Defer NETLINK_ROUTE attribute decoding (see nlmon_nl_set_lazy_decode) */
+	int lazy_decode;
+	
+	/* Network namespace the sockets live in, -1 for the caller's own.
+	 * Not owned, reconnects enter it for the new socket. */
+	int netns_fd;
+	
+	/* Sockets handed over by a previous process, by protocol slot, -1 for
+	 * none (see nlmon_nl_adopt_socket) */
+	int adopt_fds[4];
+	
+	/* Successful nlmon_nl_reconnect() calls, the fds may have changed */
+	unsigned int reconnects;
+	
+	/* Receive buffers of the protocol sockets, NULL for the heap */
+	struct nlmon_nl_msgpool *rx_pool;
+	int rx_pool_owned;
 };
 
 /**
@@ -195,6 +240,23 @@ int nlmon_nl_get_diag_fd(struct nlmon_nl_manager *mgr);
  */
 int nlmon_nl_get_nf_fd(struct nlmon_nl_manager *mgr);
 
+/**
+ * Take over a protocol socket of another process
+ * 
+ * The next enable call of @protocol uses @fd instead of opening a
+ * socket: it keeps its port, its multicast memberships and whatever the
+ * kernel queued on it, so a process handing over its sockets (see
+ * hot_upgrade.h) loses no events. Prefilters and groups are applied to
+ * it as to a new socket. A socket that turns out not to be a bound
+ * netlink socket of @protocol is closed and a new one opened.
+ * 
+ * @param mgr Netlink manager
+ * @param protocol NETLINK_ROUTE, NETLINK_GENERIC, NETLINK_SOCK_DIAG or NETLINK_NETFILTER
+ * @param fd Socket, owned by the manager on success
+ * @return 0 on success, -EALREADY if the protocol is enabled, -EINVAL
+ */
+int nlmon_nl_adopt_socket(struct nlmon_nl_manager *mgr, int protocol, int fd);
+
 /**
  * Process messages from NETLINK_ROUTE socket
  * 
@@ -253,6 +315,176 @@ void nlmon_nl_set_callback(struct nlmon_nl_manager *mgr,
                            void (*cb)(struct nlmon_event *, void *),
                            void *user_data);
 
+/**
+ * Set the buffer pool the protocol sockets receive into
+ * 
+ * nl_recvmsgs() then takes each datagram's buffer from @pool and gives
+ * it back once the callbacks have run, and the nl_msg handed to the
+ * callbacks is reused, so receiving allocates nothing. The manager
+ * starts with a pool of its own; a caller's pool replaces it and is
+ * not freed with the manager. Not to be called while receiving.
+ * 
+ * @param mgr Netlink manager
+ * @param pool Buffer pool, NULL to receive into heap buffers
+ * @return 0 on success, -EINVAL if mgr is NULL
+ */
+int nlmon_nl_set_msgpool(struct nlmon_nl_manager *mgr, struct nlmon_nl_msgpool *pool);
+
+/**
+ * Hand an event decoded by a protocol handler to the event callback
+ * 
+ * Starts the event's latency trace from the receipt of its message and
+ * stamps it parsed. When the callback handles the event inline rather
+ * than queueing it, the trace is finished here.
+ * 
+ * @param mgr Netlink manager
+ * @param evt Decoded event
+ */
+void nlmon_nl_deliver_event(struct nlmon_nl_manager *mgr, struct nlmon_event *evt);
+
+/**
+ * Timestamp of the message being handled on this thread
+ * 
+ * Taken from the coarse clock once per message as it is received, so
+ * every event decoded from the message carries the same time and later
+ * stages reuse it instead of reading a clock. Outside a receive the
+ * current coarse time.
+ * 
+ * @return Nanoseconds since the epoch
+ */
+uint64_t nlmon_nl_recv_timestamp(void);
+
+/**
+ * Attach a classic BPF prefilter to a protocol's socket
+ * 
+ * The program (e.g. from filter_compile_cbpf()) is copied and attached
+ * with SO_ATTACH_FILTER, now if the protocol is enabled and again every
+ * time its socket is (re)created. It is wrapped so that replies addressed
+ * to the socket's own port (acks, dumps, family resolution) always pass.
+ * 
+ * @param mgr Netlink manager
+ * @param protocol NETLINK_ROUTE, NETLINK_GENERIC, NETLINK_SOCK_DIAG or
+ *                 NETLINK_NETFILTER
+ * @param insns Program instructions, or NULL to remove the prefilter
+ * @param len Number of instructions
+ * @return 0 on success, negative error code on failure
+ */
+int nlmon_nl_set_filter(struct nlmon_nl_manager *mgr, int protocol,
+                        const struct sock_filter *insns, unsigned short len);
+
+/**
+ * Enable or disable lazy decoding of NETLINK_ROUTE events
+ * 
+ * When enabled, link, address, route and neighbor messages are only
+ * indexed on receive (attribute type to offset) and the event carries a
+ * pending decode instead of filled-in info fields. nlmon_event_materialize()
+ * decodes it on first use; the manager does so itself before an event is
+ * queued to the receive threads' event processor or applied to the resync
+ * state. Callbacks that only look at header fields never pay for the
+ * attribute decode. Disabled by default.
+ * 
+ * The pending decode references the received message, so it must be
+ * materialized before the event callback returns if the event is kept.
+ * 
+ * @param mgr Netlink manager
+ * @param enable Non-zero to defer decoding
+ */
+void nlmon_nl_set_lazy_decode(struct nlmon_nl_manager *mgr, int enable);
+
+/**
+ * Start per-protocol receive threads
+ * 
+ * Spawns one receive thread for every enabled protocol socket. Each
+ * thread blocks on its own socket, parses messages and hands the events
+ * to the event processor through a dedicated producer lane, so a burst
+ * on one protocol (e.g. conntrack) does not delay the others. The event
+ * callback set with nlmon_nl_set_callback() is then invoked from the
+ * event processor workers instead of the receiving thread.
+ * 
+ * While the threads are running the caller must not poll the protocol
+ * sockets or call the nlmon_nl_process_*() functions itself.
+ * 
+ * @param mgr Netlink manager with protocols enabled and callback set
+ * @param ep Event processor used to deliver events
+ * @param cpu_base First CPU to pin receive threads to (thread i runs on
+ *                 cpu_base + i, modulo online CPUs), or -1 for no pinning
+ * @return Number of threads started on success, negative error code on failure
+ */
+int nlmon_nl_start_rx_threads(struct nlmon_nl_manager *mgr,
+                              struct event_processor *ep,
+                              int cpu_base);
+
+/**
+ * Stop per-protocol receive threads
+ * 
+ * Stops and joins all receive threads, waits for queued events to be
+ * delivered and restores direct callback invocation. Safe to call when
+ * no threads are running.
+ * 
+ * @param mgr Netlink manager
+ */
+void nlmon_nl_stop_rx_threads(struct nlmon_nl_manager *mgr);
+
+/**
+ * Start an io_uring receive thread
+ * 
+ * Like nlmon_nl_start_rx_threads(), but a single thread receives all
+ * protocol sockets through one io_recv: multishot receives stay armed
+ * on every socket and the thread reaps the datagrams of all of them
+ * with one system call per batch instead of a poll() and a recvmsg()
+ * per datagram. Each protocol keeps its own producer lane. Stopped with
+ * nlmon_nl_stop_rx_threads().
+ * 
+ * @param mgr Netlink manager with protocols enabled and callback set
+ * @param ep Event processor used to deliver events
+ * @param cpu CPU to pin the thread to, or -1 for no pinning
+ * @return 1 on success, negative error code on failure, e.g. when the
+ *         kernel lacks multishot receive; nlmon_nl_start_rx_threads()
+ *         then still works
+ */
+int nlmon_nl_start_rx_uring(struct nlmon_nl_manager *mgr,
+                            struct event_processor *ep,
+                            int cpu);
+
+/**
+ * Receive protocol sockets through an io_recv
+ * 
+ * Adds every enabled protocol socket to @rx. Datagrams are parsed in
+ * place, in the io_recv's buffers, by the same callbacks that
+ * nlmon_nl_process_*() would run, on the thread calling io_recv_run().
+ * Overruns and reconnects are handled as there; a reconnected socket
+ * replaces the old one in @rx, so nlmon_nl_reconnect() must then only
+ * be called from that thread.
+ * 
+ * @param mgr Netlink manager with protocols enabled
+ * @param rx Receiver, which must outlive the attachment
+ * @return Number of sockets added, negative error code on failure
+ */
+int nlmon_nl_attach_io_recv(struct nlmon_nl_manager *mgr, struct io_recv *rx);
+
+/**
+ * Stop receiving protocol sockets through an io_recv
+ * 
+ * The receives are cancelled by the next io_recv_run(), or when the
+ * io_recv is destroyed. Safe to call when not attached.
+ * 
+ * @param mgr Netlink manager
+ */
+void nlmon_nl_detach_io_recv(struct nlmon_nl_manager *mgr);
+
+/**
+ * Attach resource limits tracker
+ * 
+ * Receive rates, buffer occupancy and overruns on manager sockets are
+ * fed to the tracker, which also drives receive buffer autotuning when
+ * enabled with nlmon_nl_limits_set_autotune(). The tracker is not owned
+ * by the manager.
+ * 
+ * @param mgr Netlink manager
+ * @param limits Limits tracker, or NULL to detach
+ */
+void nlmon_nl_set_limits(struct nlmon_nl_manager *mgr, struct nlmon_nl_limits *limits);
+
 /**
  * Apply configuration to netlink manager
  * 
@@ -267,11 +499,26 @@ void nlmon_nl_set_callback(struct nlmon_nl_manager *mgr,
 int nlmon_nl_apply_config(struct nlmon_nl_manager *mgr,
                           const struct nlmon_netlink_config *config);
 
+/**
+ * Apply the conntrack section of a configuration
+ * 
+ * Sets the conntrack filter (see nlmon_nl_set_ct_filter) from
+ * config->conntrack. Done by nlmon_nl_apply_config(), for callers that
+ * enable NETLINK_NETFILTER themselves.
+ * 
+ * @param mgr Netlink manager
+ * @param config Netlink configuration
+ * @return 0 on success, negative error code on failure
+ */
+int nlmon_nl_apply_ct_config(struct nlmon_nl_manager *mgr,
+                             const struct nlmon_netlink_config *config);
+
 /**
  * Reconnect a netlink socket after connection loss
  * 
  * Attempts to reconnect a netlink socket that has been disconnected.
- * This function will close the existing socket and create a new one.
+ * This function will close the existing socket and create a new one,
+ * in the namespace of netns_fd when the manager has one.
  * 
  * @param mgr Netlink manager
  * @param protocol Protocol to reconnect (NETLINK_ROUTE, NETLINK_GENERIC, etc.)
@@ -67,6 +67,26 @@ void nlmon_netlink_set_callback(struct nlmon_multi_protocol_ctx *ctx,
                                 void *user_data,
                                 int use_libnl);
 
+struct nlmon_event;
+
+/**
+ * Set event handler taking events in the new format
+ * 
+ * With the libnl implementation the handler bypasses the compatibility
+ * layer, so no event is converted. The legacy implementation has no
+ * such events.
+ * 
+ * @param ctx Context from nlmon_netlink_init()
+ * @param handler Event handler, NULL to go back to the event callback
+ * @param user_data User data passed to handler
+ * @param use_libnl Whether using libnl implementation
+ * @return 0 on success, -ENOTSUP with the legacy implementation
+ */
+int nlmon_netlink_set_event_handler(struct nlmon_multi_protocol_ctx *ctx,
+                                    void (*handler)(struct nlmon_event *, void *),
+                                    void *user_data,
+                                    int use_libnl);
+
 /**
  * Get file descriptor for event loop
  * 
@@ -23,6 +23,11 @@ extern "C" {
 /* Forward declarations */
 struct nlmon_nl_manager;
 struct nlmon_event;
+struct window_counter;
+struct nlmon_compat_view;
+
+/* Seconds over which nlmon_compat_get_stats() averages conversions */
+#define NLMON_COMPAT_RATE_WINDOW 10
 
 /**
  * Compatibility context structure
@@ -47,6 +52,43 @@ struct nlmon_multi_protocol_ctx_compat {
 	int route_fd;
 	int generic_fd;
 	int sock_diag_fd;
+	
+	/* Legacy consumer taking a view it converts on demand, replaces event_callback */
+	void (*view_callback)(nlmon_event_type_t type, struct nlmon_compat_view *view,
+	                      void *user_data);
+	
+	/* Native consumer, installed on the manager so the layer is skipped */
+	void (*event_handler)(struct nlmon_event *evt, void *user_data);
+	
+	/* Conversions to the legacy structures (see nlmon_compat_get_stats) */
+	uint64_t legacy_events;
+	uint64_t conversions;
+	struct window_counter *conversion_window;
+};
+
+/**
+ * Legacy view of one event
+ *
+ * Only valid during the view callback. The legacy structures are built
+ * the first time they are asked for.
+ */
+struct nlmon_compat_view {
+	struct nlmon_event *evt;
+	nlmon_event_type_t type;
+	struct nlmon_multi_protocol_ctx_compat *ctx;
+	unsigned int built;              /* Structures converted so far */
+	struct nlmon_generic_msg generic;
+	struct nlmon_sock_diag diag;
+};
+
+/**
+ * Compatibility layer statistics
+ */
+struct nlmon_compat_stats {
+	uint64_t legacy_events;          /* Events handed to legacy callbacks */
+	uint64_t conversions;            /* Legacy structures built */
+	double conversions_per_sec;      /* Over the last NLMON_COMPAT_RATE_WINDOW seconds */
+	int native;                      /* A native handler bypasses the layer */
 };
 
 /**
@@ -96,6 +138,65 @@ void nlmon_multi_protocol_set_callback_compat(struct nlmon_multi_protocol_ctx *c
                                               void (*callback)(nlmon_event_type_t, void *, void *),
                                               void *user_data);
 
+/**
+ * Set a legacy callback that converts events on demand
+ * 
+ * Like nlmon_multi_protocol_set_callback_compat(), but the callback gets
+ * a view and only pays for the structures it reads through the
+ * nlmon_compat_view_*() accessors.
+ * 
+ * @param ctx Compatibility context
+ * @param callback View callback, NULL to remove it
+ * @param user_data User data passed to callback
+ */
+void nlmon_multi_protocol_set_view_callback_compat(struct nlmon_multi_protocol_ctx *ctx,
+                                                   void (*callback)(nlmon_event_type_t,
+                                                                    struct nlmon_compat_view *,
+                                                                    void *),
+                                                   void *user_data);
+
+/**
+ * Take events in the new format, skipping the compatibility layer
+ * 
+ * The handler is installed on the wrapped manager, so events reach it
+ * with no translation at all. Legacy callbacks are dropped, setting one
+ * again puts the translator back.
+ * 
+ * @param ctx Compatibility context
+ * @param handler Event handler, NULL to go back to legacy callbacks
+ * @param user_data User data passed to handler
+ */
+void nlmon_multi_protocol_set_event_handler_compat(struct nlmon_multi_protocol_ctx *ctx,
+                                                   void (*handler)(struct nlmon_event *, void *),
+                                                   void *user_data);
+
+/**
+ * Raw netlink message of a view (route events)
+ */
+struct nlmsghdr *nlmon_compat_view_nlmsg(struct nlmon_compat_view *view);
+
+/**
+ * Legacy generic netlink structure of a view, built on first use
+ * 
+ * @return Structure, or NULL if the event is not a generic netlink one
+ */
+const struct nlmon_generic_msg *nlmon_compat_view_generic(struct nlmon_compat_view *view);
+
+/**
+ * Legacy socket diagnostics structure of a view, built on first use
+ * 
+ * @return Structure, or NULL if the event carries no socket data
+ */
+const struct nlmon_sock_diag *nlmon_compat_view_sock_diag(struct nlmon_compat_view *view);
+
+/**
+ * Get compatibility layer statistics
+ * 
+ * @param ctx Compatibility context
+ * @param stats Output for statistics
+ */
+void nlmon_compat_get_stats(struct nlmon_multi_protocol_ctx *ctx, struct nlmon_compat_stats *stats);
+
 /**
  * Get file descriptor for event loop (compatibility wrapper)
  * 
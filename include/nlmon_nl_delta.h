@@ -0,0 +1,177 @@
+/* nlmon_nl_delta.h - Suppression of NETLINK_ROUTE updates that change nothing
+ *
+ * Drivers resend RTM_NEWLINK with the same flags and operstate, and stats
+ * refreshes or address lifetime updates arrive as new events carrying no
+ * change in the fields nlmon parses. The delta stage keeps a digest of the
+ * meaningful fields of every link, address, route and neighbor and drops
+ * an update whose digest matches the last one before it reaches the event
+ * callback. Dropped updates are counted as heartbeats of their object.
+ *
+ * The fields that count are chosen per object kind. An identity field
+ * (interface index, address, prefix, table...) always counts, as it tells
+ * objects apart.
+ */
+
+#ifndef NLMON_NL_DELTA_H
+#define NLMON_NL_DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Forward declarations */
+struct nlmon_event;
+struct nlmon_nl_manager;
+
+/* Opaque digest table */
+struct nlmon_nl_delta;
+
+/* Objects tracked when created with a limit of 0 */
+#define NLMON_NL_DELTA_DEFAULT_OBJECTS 65536
+
+/**
+ * Object kinds compared
+ */
+enum nlmon_nl_delta_kind {
+	NLMON_NL_DELTA_LINK = 0,
+	NLMON_NL_DELTA_ADDR,
+	NLMON_NL_DELTA_ROUTE,
+	NLMON_NL_DELTA_NEIGH,
+	NLMON_NL_DELTA_KIND_COUNT
+};
+
+/* Link fields */
+#define NLMON_NL_DELTA_LINK_IFNAME     (1u << 0)
+#define NLMON_NL_DELTA_LINK_FLAGS      (1u << 1)
+#define NLMON_NL_DELTA_LINK_MTU        (1u << 2)
+#define NLMON_NL_DELTA_LINK_ADDRESS    (1u << 3)
+#define NLMON_NL_DELTA_LINK_QDISC      (1u << 4)
+#define NLMON_NL_DELTA_LINK_OPERSTATE  (1u << 5)
+
+/* Address fields */
+#define NLMON_NL_DELTA_ADDR_SCOPE      (1u << 0)
+#define NLMON_NL_DELTA_ADDR_LABEL      (1u << 1)
+
+/* Route fields */
+#define NLMON_NL_DELTA_ROUTE_GATEWAY   (1u << 0)
+#define NLMON_NL_DELTA_ROUTE_OIF       (1u << 1)
+#define NLMON_NL_DELTA_ROUTE_SRC       (1u << 2)
+#define NLMON_NL_DELTA_ROUTE_PROTOCOL  (1u << 3)
+#define NLMON_NL_DELTA_ROUTE_SCOPE     (1u << 4)
+#define NLMON_NL_DELTA_ROUTE_TYPE      (1u << 5)
+
+/* Neighbor fields */
+#define NLMON_NL_DELTA_NEIGH_STATE     (1u << 0)
+#define NLMON_NL_DELTA_NEIGH_FLAGS     (1u << 1)
+#define NLMON_NL_DELTA_NEIGH_LLADDR    (1u << 2)
+
+/* Every field of a kind, the default */
+#define NLMON_NL_DELTA_ALL_FIELDS      0xffffffffu
+
+/**
+ * Delta statistics of one object kind
+ */
+struct nlmon_nl_delta_kind_stats {
+	uint64_t changed;                /* Updates passed as new or changed */
+	uint64_t heartbeats;             /* Unchanged updates dropped */
+	uint64_t heartbeats_passed;      /* Unchanged updates passed by the heartbeat interval */
+	uint64_t untracked;              /* Passed as the table was full */
+};
+
+/**
+ * Delta statistics
+ */
+struct nlmon_nl_delta_stats {
+	struct nlmon_nl_delta_kind_stats kinds[NLMON_NL_DELTA_KIND_COUNT];
+	uint64_t objects;                /* Objects currently tracked */
+};
+
+/**
+ * Create a digest table
+ *
+ * @param max_objects Most objects tracked, 0 for NLMON_NL_DELTA_DEFAULT_OBJECTS
+ * @return Digest table, or NULL on allocation failure
+ */
+struct nlmon_nl_delta *nlmon_nl_delta_create(size_t max_objects);
+
+/**
+ * Destroy a digest table
+ *
+ * @param delta Digest table
+ */
+void nlmon_nl_delta_destroy(struct nlmon_nl_delta *delta);
+
+/**
+ * Choose the fields whose change lets an update through
+ *
+ * Digests taken before the change no longer match, so each object passes
+ * once more after it.
+ *
+ * @param delta Digest table
+ * @param kind Object kind
+ * @param fields NLMON_NL_DELTA_<KIND>_* fields, 0 to pass every update of the kind
+ * @return 0 on success, -EINVAL for an unknown kind
+ */
+int nlmon_nl_delta_set_fields(struct nlmon_nl_delta *delta,
+                              enum nlmon_nl_delta_kind kind, uint32_t fields);
+
+/**
+ * Let an unchanged object through now and then
+ *
+ * With an interval, the first unchanged update of an object after that
+ * many seconds without one passing goes through, so consumers watching
+ * for liveness still hear from quiet objects.
+ *
+ * @param delta Digest table
+ * @param seconds Interval, 0 to drop every unchanged update (the default)
+ */
+void nlmon_nl_delta_set_heartbeat(struct nlmon_nl_delta *delta, unsigned int seconds);
+
+/**
+ * Compare an event against the last digest of its object
+ *
+ * NEW events of tracked kinds record their digest, DEL events forget the
+ * object and always pass. Events of other types and protocols pass.
+ *
+ * @param delta Digest table
+ * @param evt Parsed event, materialized if its decode is pending
+ * @return 1 if the event goes on, 0 if it only repeats the last state
+ */
+int nlmon_nl_delta_check(struct nlmon_nl_delta *delta, struct nlmon_event *evt);
+
+/**
+ * Forget every object
+ *
+ * @param delta Digest table
+ */
+void nlmon_nl_delta_clear(struct nlmon_nl_delta *delta);
+
+/**
+ * Get delta statistics
+ *
+ * @param delta Digest table
+ * @param stats Output for statistics
+ */
+void nlmon_nl_delta_get_stats(struct nlmon_nl_delta *delta, struct nlmon_nl_delta_stats *stats);
+
+/**
+ * Attach a digest table to a manager
+ *
+ * Events the manager delivers pass through nlmon_nl_delta_check() first
+ * and unchanged updates never reach the event callback. Synthetic events
+ * of a resynchronization are deltas already and are not checked. The
+ * table is not owned by the manager.
+ *
+ * @param mgr Netlink manager
+ * @param delta Digest table, or NULL to detach
+ */
+void nlmon_nl_set_delta(struct nlmon_nl_manager *mgr, struct nlmon_nl_delta *delta);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NLMON_NL_DELTA_H */
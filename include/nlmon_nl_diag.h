@@ -13,6 +13,16 @@ struct nlmon_event;
 struct nlmon_nl_manager;
 struct nl_msg;
 
+/**
+ * Change reported by an incremental dump (see nlmon_nl_diag_dump.h)
+ */
+enum nlmon_diag_change {
+	NLMON_DIAG_CHANGE_NONE = 0,      /* Not from an incremental dump */
+	NLMON_DIAG_CHANGE_NEW,
+	NLMON_DIAG_CHANGE_CHANGED,
+	NLMON_DIAG_CHANGE_GONE,
+};
+
 /**
  * Socket diagnostic information structure
  */
@@ -30,6 +40,7 @@ struct nlmon_diag_info {
 	uint32_t wqueue;                 /* Write queue size */
 	uint8_t timer;                   /* Timer state */
 	uint8_t retrans;                 /* Retransmission count */
+	uint8_t change;                  /* enum nlmon_diag_change */
 };
 
 /**
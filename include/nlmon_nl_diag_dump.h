@@ -0,0 +1,174 @@
+/* nlmon_nl_diag_dump.h - Kernel-filtered, incremental socket diagnostics dumps
+ *
+ * A full NETLINK_SOCK_DIAG dump of a busy host means hundreds of thousands
+ * of messages. The socket filters are compiled into INET_DIAG_REQ_BYTECODE
+ * so the kernel only returns the sockets wanted, and each dump is diffed
+ * against a table of the sockets seen by the last one so only new, changed
+ * and vanished sockets are reported. The dump interval stretches while
+ * nothing changes and shrinks back when churn picks up.
+ *
+ * A dumper is used from one thread at a time.
+ */
+
+#ifndef NLMON_NL_DIAG_DUMP_H
+#define NLMON_NL_DIAG_DUMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Forward declarations */
+struct nlmon_event;
+struct nlmon_nl_manager;
+
+/* Opaque dumper */
+struct nlmon_diag_dump;
+
+/* Limits and defaults */
+#define NLMON_DIAG_DUMP_MAX_FILTERS       16
+#define NLMON_DIAG_DUMP_DEFAULT_SOCKETS   (1024 * 1024)
+#define NLMON_DIAG_DUMP_DEFAULT_MIN_INTERVAL 5       /* Seconds */
+#define NLMON_DIAG_DUMP_DEFAULT_MAX_INTERVAL 300
+#define NLMON_DIAG_DUMP_BYTECODE_MAX      2048      /* Bytes of bytecode per dump */
+
+/**
+ * Sockets to dump
+ *
+ * Conditions of a filter must all hold, a socket is dumped if any filter
+ * matches it. Filters of one family and protocol share one request, so
+ * their state masks are merged.
+ */
+struct nlmon_diag_filter {
+	uint8_t family;                  /* AF_INET, AF_INET6, AF_UNSPEC for both */
+	uint8_t protocol;                /* IPPROTO_TCP (0) or IPPROTO_UDP */
+	uint32_t states;                 /* Mask of 1 << TCP_* states, 0 for all */
+	uint16_t sport_min;              /* Local port range, 0 for no bound */
+	uint16_t sport_max;
+	uint16_t dport_min;              /* Remote port range, 0 for no bound */
+	uint16_t dport_max;
+	char src[64];                    /* Local address prefix, "" for any */
+	uint8_t src_len;
+	char dst[64];                    /* Remote address prefix, "" for any */
+	uint8_t dst_len;
+};
+
+/**
+ * Dumper configuration
+ */
+struct nlmon_diag_dump_config {
+	const struct nlmon_diag_filter *filters;  /* Copied, NULL for every TCP and UDP socket */
+	size_t filter_count;
+	size_t max_sockets;              /* Sockets tracked, 0 for the default */
+	unsigned int min_interval;       /* Seconds between dumps while sockets churn */
+	unsigned int max_interval;       /* Seconds between dumps while nothing changes */
+	bool silent_baseline;            /* Only record the sockets of the first dump */
+};
+
+/**
+ * Dumper statistics
+ */
+struct nlmon_diag_dump_stats {
+	uint64_t dumps;                  /* Completed dumps */
+	uint64_t failures;               /* Dumps abandoned on an error */
+	uint64_t messages;               /* Socket messages received */
+	uint64_t sockets_new;
+	uint64_t sockets_changed;
+	uint64_t sockets_gone;
+	uint64_t untracked;              /* Sockets past max_sockets, not reported */
+	uint64_t sockets;                /* Sockets currently tracked */
+	unsigned int interval;           /* Seconds until the next dump */
+};
+
+/* Receives the events of new, changed and vanished sockets */
+typedef void (*nlmon_diag_dump_cb)(struct nlmon_event *evt, void *ctx);
+
+/**
+ * Compile filters into INET_DIAG_REQ_BYTECODE
+ *
+ * Only the filters applying to @family and @protocol are compiled.
+ *
+ * @param filters Filters
+ * @param count Number of filters
+ * @param family AF_INET or AF_INET6
+ * @param protocol IPPROTO_TCP or IPPROTO_UDP
+ * @param buf Output for the bytecode
+ * @param size Size of @buf
+ * @return Bytecode length, 0 if a filter takes every socket so none is
+ *         needed, -ENOENT if no filter applies, -EINVAL for a bad filter
+ *         or -ENOSPC if @buf is too small
+ */
+int nlmon_diag_compile_filters(const struct nlmon_diag_filter *filters, size_t count,
+                               int family, int protocol, void *buf, size_t size);
+
+/**
+ * Create a dumper
+ *
+ * @param config Configuration, NULL for the defaults
+ * @return Dumper, or NULL on allocation failure or a bad filter
+ */
+struct nlmon_diag_dump *nlmon_diag_dump_create(const struct nlmon_diag_dump_config *config);
+
+/**
+ * Destroy a dumper
+ *
+ * @param dump Dumper
+ */
+void nlmon_diag_dump_destroy(struct nlmon_diag_dump *dump);
+
+/**
+ * Dump the filtered sockets now and report the differences
+ *
+ * Each difference is passed to @cb as a SOCK_DIAG_BY_FAMILY event whose
+ * nlmon_diag_info carries NLMON_DIAG_CHANGE_NEW, _CHANGED or _GONE. A
+ * socket changes when its state or owner does, queues and timers do not
+ * count. A socket that moves to TIME_WAIT loses its inode and shows as a
+ * new one. Nothing is reported gone from a dump that failed.
+ *
+ * @param dump Dumper
+ * @param cb Event callback
+ * @param ctx Callback context
+ * @return Number of events passed, or negative error code
+ */
+int nlmon_diag_dump_run(struct nlmon_diag_dump *dump, nlmon_diag_dump_cb cb, void *ctx);
+
+/**
+ * Check whether the next dump is due
+ *
+ * @param dump Dumper
+ * @param now Seconds, e.g. nlmon_clock_seconds()
+ * @return true once the current interval has passed since the last dump
+ */
+bool nlmon_diag_dump_due(struct nlmon_diag_dump *dump, time_t now);
+
+/**
+ * Get dumper statistics
+ *
+ * @param dump Dumper
+ * @param stats Output for statistics
+ */
+void nlmon_diag_dump_get_stats(struct nlmon_diag_dump *dump, struct nlmon_diag_dump_stats *stats);
+
+/**
+ * Run a dump through a manager if one is due
+ *
+ * Events are handed to the manager's callback as the diag socket's own
+ * would be. Meant for the manager's periodic tick. The dumper is not owned
+ * by the manager.
+ *
+ * @param mgr Netlink manager
+ * @param dump Dumper
+ * @return Number of events delivered, 0 if no dump was due, or negative
+ *         error code
+ */
+int nlmon_nl_diag_dump_poll(struct nlmon_nl_manager *mgr, struct nlmon_diag_dump *dump);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NLMON_NL_DIAG_DUMP_H */
@@ -0,0 +1,87 @@
+#ifndef NLMON_NL_DISPATCH_H
+#define NLMON_NL_DISPATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "nlmon_nl_optimize.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Forward declarations */
+struct nlmsghdr;
+struct nlmon_event;
+struct nlmon_nl_manager;
+struct nl_msg;
+
+/* Consumers of a message type inside the netlink layer */
+#define NLMON_NL_SUB_EVENTS  0x01  /* Event callback: filters, detectors, plugins, exporters */
+#define NLMON_NL_SUB_CACHE   0x02  /* Object cache, see cache_update */
+#define NLMON_NL_SUB_STATE   0x04  /* Resync baseline, stores the decoded object */
+#define NLMON_NL_SUB_FAMILY  0x08  /* Generic netlink family cache */
+
+/**
+ * Everything the handlers need to know about one message type
+ *
+ * One const entry per (protocol, nlmsg_type), built by the compiler from
+ * designated initializers, so routing a message is a bounds check and an
+ * index instead of a switch in every stage. Generic netlink family IDs
+ * are assigned at runtime, its entries are keyed by family name and bound
+ * to the ID when the family is first seen.
+ */
+struct nlmon_nl_msg_desc {
+	const char *name;                /* Message type or family name */
+	enum nlmon_msg_class msg_class;  /* Classification */
+	uint16_t hdrlen;                 /* Family header before the attributes, 0 if none */
+	uint8_t subscribers;             /* NLMON_NL_SUB_* */
+	size_t payload_size;             /* Size of the parsed data attached to the event */
+
+	/* Eager parser, NULL if the message carries nothing to parse */
+	int (*parse)(struct nlmsghdr *nlh, struct nlmon_event *evt);
+
+	/* Table based decoder, NULL if there is none */
+	const struct nlmon_nl_decode_table *decoder;
+
+	/* Keeps the object cache current, NULL if not cached */
+	int (*cache_update)(struct nlmon_nl_manager *mgr, struct nl_msg *msg);
+};
+
+/**
+ * Look up the descriptor of a message type
+ *
+ * For NETLINK_GENERIC @msg_type is the family ID, found only once bound
+ * with nlmon_nl_msg_bind_genl(). The controller is always bound.
+ *
+ * @param protocol NETLINK_* protocol
+ * @param msg_type nlmsg_type
+ * @return Descriptor, NULL for types the handlers do not route
+ */
+const struct nlmon_nl_msg_desc *nlmon_nl_msg_lookup(int protocol, uint16_t msg_type);
+
+/**
+ * Bind a generic netlink family ID to the descriptor of its name
+ *
+ * Families without an entry of their own get one that only forwards
+ * events. Thread safe; later lookups of @family_id find the result.
+ *
+ * @param family_id Family ID
+ * @param family Family name
+ * @return Descriptor, NULL if @family_id is out of range
+ */
+const struct nlmon_nl_msg_desc *nlmon_nl_msg_bind_genl(uint16_t family_id, const char *family);
+
+/**
+ * Forget the generic netlink bindings
+ *
+ * Called when the controller announces families, as an ID of a removed
+ * family may be reused by a new one.
+ */
+void nlmon_nl_msg_unbind_genl(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NLMON_NL_DISPATCH_H */
@@ -1,6 +1,7 @@
 #ifndef NLMON_NL_EVENT_H
 #define NLMON_NL_EVENT_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <linux/netlink.h>
 
@@ -27,6 +28,19 @@ struct nlmsghdr;
  */
 int nlmon_nl_msg_to_event(struct nl_msg *msg, struct nlmon_event *evt, int protocol);
 
+/**
+ * Convert a bare netlink message to nlmon event
+ * 
+ * As nlmon_nl_msg_to_event(), for a message that is not in an nl_msg,
+ * such as one replayed from a capture file.
+ * 
+ * @param nlh Netlink message header, nlmsg_len bytes are read
+ * @param evt Event structure to populate
+ * @param protocol Netlink protocol (NETLINK_ROUTE, NETLINK_GENERIC, etc.)
+ * @return 0 on success, negative error code on failure
+ */
+int nlmon_nl_parse_message(struct nlmsghdr *nlh, struct nlmon_event *evt, int protocol);
+
 /**
  * Extract common netlink header information
  * 
@@ -52,6 +66,18 @@ void nlmon_nl_extract_header(struct nlmsghdr *nlh, struct nlmon_event *evt);
 int nlmon_nl_parse_attributes(struct nlmsghdr *nlh, int hdrlen,
                                struct nlmon_event *evt);
 
+/**
+ * Get size of the parsed attribute payload attached to an event
+ * 
+ * Returns the size of the protocol-specific info structure referenced by
+ * evt->netlink.data, so the payload can be copied when the event has to
+ * outlive the netlink handler (e.g. when queued to another thread).
+ * 
+ * @param evt Event structure
+ * @return Payload size in bytes, or 0 if the event carries no payload
+ */
+size_t nlmon_nl_event_payload_size(const struct nlmon_event *evt);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,129 @@
+/* nlmon_nl_family.h - Generic netlink family cache
+ *
+ * Process-wide cache of the generic netlink families, keyed by family
+ * ID. It is filled with one CTRL_CMD_GETFAMILY dump and kept current by
+ * the nlctrl "notify" multicast group, so family names, versions and
+ * multicast groups are looked up without a controller round trip.
+ */
+
+#ifndef NLMON_NL_FAMILY_H
+#define NLMON_NL_FAMILY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/genetlink.h>
+
+struct nl_sock;
+struct nlmsghdr;
+
+#define NLMON_GENL_FAMILY_MAX_GROUPS 16
+
+/**
+ * struct nlmon_genl_mcast_group - Multicast group of a family
+ * @id: Group ID to join
+ * @name: Group name
+ */
+struct nlmon_genl_mcast_group {
+	uint32_t id;
+	char name[GENL_NAMSIZ];
+};
+
+/**
+ * struct nlmon_genl_family - Cached generic netlink family
+ * @id: Family ID, the nlmsg_type of its messages
+ * @version: Family version
+ * @name: Family name
+ * @ngroups: Number of entries in @groups
+ * @groups: Multicast groups
+ */
+struct nlmon_genl_family {
+	uint16_t id;
+	uint32_t version;
+	char name[GENL_NAMSIZ];
+	unsigned int ngroups;
+	struct nlmon_genl_mcast_group groups[NLMON_GENL_FAMILY_MAX_GROUPS];
+};
+
+/**
+ * nlmon_genl_family_cache_fill() - Fill the cache from the controller
+ * @sock: Blocking NETLINK_GENERIC socket
+ *
+ * Dumps all families with CTRL_CMD_GETFAMILY. Families missing from the
+ * dump are dropped, so refilling after a reconnect also forgets the
+ * families unregistered in between.
+ *
+ * Returns: Number of families cached, or negative error code
+ */
+int nlmon_genl_family_cache_fill(struct nl_sock *sock);
+
+/**
+ * nlmon_genl_family_cache_subscribe() - Join the nlctrl notify group
+ * @sock: NETLINK_GENERIC socket whose messages reach
+ *        nlmon_genl_family_cache_update()
+ *
+ * Needs the cache filled, as the group ID comes from the nlctrl entry.
+ *
+ * Returns: 0 on success, negative error code on failure
+ */
+int nlmon_genl_family_cache_subscribe(struct nl_sock *sock);
+
+/**
+ * nlmon_genl_family_cache_update() - Apply a controller message
+ * @nlh: Netlink message header
+ *
+ * Applies CTRL_CMD_NEWFAMILY, CTRL_CMD_DELFAMILY, CTRL_CMD_NEWMCAST_GRP
+ * and CTRL_CMD_DELMCAST_GRP messages, whether dump replies or
+ * notifications. Other messages are ignored.
+ *
+ * Returns: 1 if the cache changed, 0 if the message was not for it, or
+ *          negative error code
+ */
+int nlmon_genl_family_cache_update(const struct nlmsghdr *nlh);
+
+/**
+ * nlmon_genl_family_cache_clear() - Drop all cached families
+ */
+void nlmon_genl_family_cache_clear(void);
+
+/**
+ * nlmon_genl_family_name() - Name of a family
+ * @id: Family ID
+ * @buf: Output buffer
+ * @len: Size of @buf
+ *
+ * Hashed lookup, cheap enough for every message.
+ *
+ * Returns: 0 on success, -ENOENT if the family is not cached
+ */
+int nlmon_genl_family_name(uint16_t id, char *buf, size_t len);
+
+/**
+ * nlmon_genl_family_lookup() - Cached family by ID
+ * @id: Family ID
+ * @family: Output, a copy of the entry
+ *
+ * Returns: 0 on success, -ENOENT if the family is not cached
+ */
+int nlmon_genl_family_lookup(uint16_t id, struct nlmon_genl_family *family);
+
+/**
+ * nlmon_genl_family_find() - Cached family by name
+ * @name: Family name
+ * @family: Output, a copy of the entry (can be NULL)
+ *
+ * Walks the cache, meant for setup rather than per-message use.
+ *
+ * Returns: Family ID, or -ENOENT if the family is not cached
+ */
+int nlmon_genl_family_find(const char *name, struct nlmon_genl_family *family);
+
+/**
+ * nlmon_genl_family_group() - Multicast group ID by name
+ * @family: Family name
+ * @group: Group name
+ *
+ * Returns: Group ID, or -ENOENT if the family or group is not cached
+ */
+int nlmon_genl_family_group(const char *family, const char *group);
+
+#endif /* NLMON_NL_FAMILY_H */
@@ -8,13 +8,13 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
-
+	
 /* Forward declarations */
 struct nlmsghdr;
 struct nlmon_event;
 struct nlmon_nl_manager;
 struct nl_msg;
-
+	
 /**
  * nl80211 information structure
  */
@@ -28,7 +28,7 @@ struct nlmon_nl80211_info {
 	uint32_t freq;                   /* Frequency (MHz) */
 	uint32_t channel_type;           /* Channel type */
 };
-
+	
 /**
  * QCA vendor information structure
  */
@@ -36,9 +36,56 @@ struct nlmon_qca_vendor_info {
 	uint32_t subcmd;                 /* QCA vendor subcommand */
 	char subcmd_name[64];            /* Subcommand name */
 	uint32_t vendor_id;              /* Vendor ID (OUI) */
-	/* Additional vendor-specific data can be added here */
+		
+	/* Vendor data, decoded at NLMON_GENL_DEPTH_VENDOR for subcommands
+	 * whose data uses enum qca_wlan_vendor_attr */
+	uint32_t data_len;               /* Vendor data length */
+	uint8_t data_decoded;            /* Vendor data attributes were decoded */
+	uint8_t fw_state;                /* QCA_WLAN_VENDOR_ATTR_FW_STATE */
+	uint8_t mac[ETH_ALEN];           /* QCA_WLAN_VENDOR_ATTR_MAC_ADDR */
+	uint32_t ifindex;                /* QCA_WLAN_VENDOR_ATTR_IFINDEX */
+	uint32_t freq;                   /* QCA_WLAN_VENDOR_ATTR_FREQ (MHz) */
+	uint32_t setband_mask;           /* QCA_WLAN_VENDOR_ATTR_SETBAND_MASK */
+	uint64_t tsf;                    /* QCA_WLAN_VENDOR_ATTR_TSF */
 };
-
+	
+/**
+ * nl80211 decode depths
+ */
+enum nlmon_genl_depth {
+	NLMON_GENL_DEPTH_CMD = 0,        /* Command only, no attributes */
+	NLMON_GENL_DEPTH_ATTRS,          /* Top-level attributes (default) */
+	NLMON_GENL_DEPTH_VENDOR          /* QCA vendor data attributes too */
+};
+	
+/**
+ * nl80211 decode configuration
+ */
+struct nlmon_genl_decode_config {
+	unsigned int depth;              /* enum nlmon_genl_depth */
+	const uint16_t *attrs;           /* NL80211_ATTR_* to decode, NULL for all */
+	unsigned int nattrs;             /* Number of entries in attrs */
+};
+	
+/**
+ * Set how deep nl80211 messages are decoded
+ * 
+ * Attributes are walked once and only the types in the whitelist are
+ * decoded, everything else is skipped by its length. The whitelist can
+ * hold the types the info structures have fields for: WIPHY, IFINDEX,
+ * IFTYPE, MAC, WIPHY_FREQ and WIPHY_CHANNEL_TYPE, plus VENDOR_DATA.
+ * VENDOR_ID and VENDOR_SUBCMD are always decoded so vendor commands
+ * can be told apart, except at NLMON_GENL_DEPTH_CMD, where they are
+ * reported as plain nl80211 commands.
+ * 
+ * Call before messages are parsed, it is not synchronized with them.
+ * 
+ * @param config Decode configuration, NULL for the defaults
+ * @return 0 on success, -EINVAL for an unknown depth or an attribute
+ *         that has no field
+ */
+int nlmon_genl_set_decode_config(const struct nlmon_genl_decode_config *config);
+	
 /**
  * Generic netlink message callback handler
  * 
@@ -49,7 +96,7 @@ struct nlmon_qca_vendor_info {
  * @return NL_OK to continue, NL_STOP to stop, or negative error code
  */
 int nlmon_genl_msg_handler(struct nl_msg *msg, void *arg);
-
+	
 /**
  * Parse nl80211 message
  * 
@@ -58,7 +105,7 @@ int nlmon_genl_msg_handler(struct nl_msg *msg, void *arg);
  * @return 0 on success, negative error code on failure
  */
 int nlmon_parse_nl80211_msg(struct nlmsghdr *nlh, struct nlmon_event *evt);
-
+	
 /**
  * Parse QCA vendor command message
  * 
@@ -67,7 +114,7 @@ int nlmon_parse_nl80211_msg(struct nlmsghdr *nlh, struct nlmon_event *evt);
  * @return 0 on success, negative error code on failure
  */
 int nlmon_parse_qca_vendor_msg(struct nlmsghdr *nlh, struct nlmon_event *evt);
-
+	
 #ifdef __cplusplus
 }
 #endif
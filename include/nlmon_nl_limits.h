@@ -10,10 +10,13 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <sys/types.h>
+#include "memory_governor.h"
 
 /* Resource limits handle (opaque) */
 struct nlmon_nl_limits;
 
+struct nlmon_stats_snapshot;
+
 /* Resource statistics */
 struct nlmon_nl_resource_stats {
 	/* Memory stats */
@@ -42,6 +45,35 @@ struct nlmon_nl_resource_stats {
 	uint64_t max_processing_time_ns;
 };
 
+/* Receive buffer autotuning parameters */
+struct nlmon_nl_autotune_config {
+	bool enabled;
+	size_t min_rcvbuf;            /* Floor, never shrink below (bytes) */
+	size_t max_rcvbuf;            /* Ceiling, never grow above (bytes) */
+	double grow_occupancy;        /* Queue occupancy (%) that triggers growth */
+	double grow_load;             /* Arrival/drain ratio that triggers growth */
+	unsigned int idle_samples;    /* Idle samples before shrinking */
+};
+
+/* Reason for a receive buffer adjustment */
+enum nlmon_nl_autotune_reason {
+	NLMON_NL_AUTOTUNE_OVERRUN,    /* Socket reported ENOBUFS */
+	NLMON_NL_AUTOTUNE_OCCUPANCY,  /* Queue filled past grow_occupancy */
+	NLMON_NL_AUTOTUNE_LOAD,       /* Arrival rate approached drain rate */
+	NLMON_NL_AUTOTUNE_IDLE,       /* Traffic idle, buffer released */
+	NLMON_NL_AUTOTUNE_PRESSURE,   /* Memory governor lowered the ceiling */
+};
+
+/* Record of one receive buffer adjustment */
+struct nlmon_nl_autotune_event {
+	time_t timestamp;
+	int fd;
+	size_t old_size;
+	size_t new_size;
+	enum nlmon_nl_autotune_reason reason;
+	bool forced;                  /* Applied with SO_RCVBUFFORCE */
+};
+
 /* Health status */
 struct nlmon_nl_health_status {
 	bool overall_healthy;
@@ -144,6 +176,60 @@ void nlmon_nl_limits_update_socket_buffer(struct nlmon_nl_limits *limits,
                                          size_t buffer_used,
                                          size_t drops);
 
+/**
+ * nlmon_nl_limits_record_batch() - Record a batch of received messages
+ * @limits: Limits handle
+ * @fd: Socket the batch was read from, -1 if unknown
+ * @messages: Number of messages in the batch
+ * @bytes: Total message bytes
+ * @processing_time_ns: Time spent processing the whole batch
+ *
+ * Equivalent to calling nlmon_nl_limits_record_message() for each
+ * message with the batch time split evenly, but takes the lock once.
+ * The messages and time also count towards @fd's autotuning load.
+ */
+void nlmon_nl_limits_record_batch(struct nlmon_nl_limits *limits,
+                                  int fd,
+                                  size_t messages,
+                                  size_t bytes,
+                                  uint64_t processing_time_ns);
+
+/**
+ * nlmon_nl_limits_set_autotune() - Configure receive buffer autotuning
+ * @limits: Limits handle
+ * @config: Autotuning parameters (NULL restores defaults, disabled)
+ */
+void nlmon_nl_limits_set_autotune(struct nlmon_nl_limits *limits,
+                                  const struct nlmon_nl_autotune_config *config);
+
+/**
+ * nlmon_nl_limits_autotune() - Run one autotuning step for a socket
+ * @limits: Limits handle
+ * @fd: Netlink socket to tune
+ * @overrun: true if the socket just reported ENOBUFS
+ *
+ * Samples the socket's queue occupancy and the arrival and drain rates
+ * of the batches recorded for it by nlmon_nl_limits_record_batch() at
+ * most once per sample interval (immediately on overrun). The receive
+ * buffer is doubled when the queue fills, when the arrival rate
+ * approaches the drain rate or on overrun, and halved back towards
+ * the floor after idle_samples idle intervals. Buffers are set with
+ * SO_RCVBUFFORCE, falling back to SO_RCVBUF (capped by rmem_max) without
+ * CAP_NET_ADMIN. Under memory pressure buffers above the ceiling set by
+ * nlmon_nl_limits_memory_respond() shrink to it on their next sample.
+ * Adjustments appear in nlmon_nl_limits_export_json().
+ *
+ * Returns: New buffer size if adjusted, 0 if unchanged, negative errno on error
+ */
+ssize_t nlmon_nl_limits_autotune(struct nlmon_nl_limits *limits, int fd, bool overrun);
+
+/**
+ * nlmon_nl_limits_forget_socket() - Drop autotuning state for a socket
+ * @limits: Limits handle
+ * @fd: Socket being closed
+ */
+void nlmon_nl_limits_forget_socket(struct nlmon_nl_limits *limits, int fd);
+
 /**
  * nlmon_nl_limits_get_stats() - Get resource statistics
  * @limits: Limits handle
@@ -152,6 +238,15 @@ void nlmon_nl_limits_update_socket_buffer(struct nlmon_nl_limits *limits,
 void nlmon_nl_limits_get_stats(struct nlmon_nl_limits *limits,
                                struct nlmon_nl_resource_stats *stats);
 
+/**
+ * nlmon_nl_limits_collect_stats() - Stats bus collector
+ * @snapshot: Snapshot to fill
+ * @ctx: Limits handle
+ *
+ * Fills the netlink part, see stats_bus_add_source().
+ */
+void nlmon_nl_limits_collect_stats(struct nlmon_stats_snapshot *snapshot, void *ctx);
+
 /**
  * nlmon_nl_limits_reset_stats() - Reset statistics
  * @limits: Limits handle
@@ -196,5 +291,27 @@ size_t nlmon_nl_limits_get_memory_usage(struct nlmon_nl_limits *limits);
  */
 size_t nlmon_nl_limits_get_message_rate(struct nlmon_nl_limits *limits);
 
+/**
+ * nlmon_nl_limits_memory_usage() - Memory governor usage report
+ * @ctx: Limits handle
+ *
+ * Tracked allocations plus what the tuned receive buffers may hold, the
+ * kernel's bookkeeping included.
+ *
+ * Returns: Bytes
+ */
+size_t nlmon_nl_limits_memory_usage(void *ctx);
+
+/**
+ * nlmon_nl_limits_memory_respond() - Memory governor pressure response
+ * @ctx: Limits handle
+ * @level: Pressure level
+ * @target: Bytes to stay within
+ *
+ * From HIGH on, caps autotuning so the receive buffers together fit
+ * @target; lower levels lift the cap.
+ */
+void nlmon_nl_limits_memory_respond(void *ctx, enum memory_pressure level, size_t target);
+
 #endif /* NLMON_NL_LIMITS_H */
 
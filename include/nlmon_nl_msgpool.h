@@ -1,6 +1,8 @@
 /* nlmon_nl_msgpool.h - Message buffer pool for netlink
  *
  * Memory pool for netlink message buffers to reduce allocation overhead.
+ * Buffers come in size classes from 512 bytes to 64KB, so large link
+ * dumps and scan results are pooled too.
  */
 
 #ifndef NLMON_NL_MSGPOOL_H
@@ -10,6 +12,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/* Number of size classes, 512 bytes doubling up to 64KB */
+#define NLMON_MSGPOOL_CLASSES 8
+
 /* Message pool handle (opaque) */
 struct nlmon_nl_msgpool;
 
@@ -25,12 +30,23 @@ struct nlmon_msgpool_stats {
 	double hit_rate;           /* Pool hit rate percentage */
 };
 
+/* Size class statistics */
+struct nlmon_msgpool_class_stats {
+	size_t buffer_size;        /* Size of each buffer in the class */
+	size_t buffer_count;       /* Buffers in the class */
+	size_t allocated_count;    /* Currently allocated buffers */
+	size_t hits;               /* Allocations served by the class */
+	size_t misses;             /* Requests of this size that went to the heap */
+};
+
 /**
  * nlmon_nl_msgpool_create() - Create message pool
- * @pool_size: Number of buffers in pool (0 for default)
- * @buffer_size: Size of each buffer (0 for default)
+ * @pool_size: Number of buffers per size class (0 for default)
+ * @buffer_size: Typical message size (0 for default)
  *
- * Creates a pool of pre-allocated message buffers.
+ * Creates a pool of pre-allocated message buffers. Classes up to
+ * @buffer_size get @pool_size buffers, each larger class half as many
+ * as the one below.
  *
  * Returns: Pool handle or NULL on error
  */
@@ -49,8 +65,9 @@ void nlmon_nl_msgpool_destroy(struct nlmon_nl_msgpool *pool);
  * @pool: Pool handle
  * @size: Requested size
  *
- * Allocates a buffer from the pool. If pool is exhausted or size is too large,
- * falls back to malloc().
+ * Allocates a buffer from the smallest class @size fits in, or from one
+ * of the next two classes if that one is exhausted. If those are
+ * exhausted or size is too large, falls back to malloc(). Lock-free.
  *
  * Returns: Buffer pointer or NULL on error
  */
@@ -75,6 +92,18 @@ void nlmon_nl_msgpool_free(struct nlmon_nl_msgpool *pool, void *ptr);
 void nlmon_nl_msgpool_get_stats(struct nlmon_nl_msgpool *pool,
                                 struct nlmon_msgpool_stats *stats);
 
+/**
+ * nlmon_nl_msgpool_get_class_stats() - Get per size class statistics
+ * @pool: Pool handle
+ * @stats: Output array, may be NULL if @max is 0
+ * @max: Number of entries in @stats
+ *
+ * Returns: Number of size classes, at most @max entries filled
+ */
+size_t nlmon_nl_msgpool_get_class_stats(struct nlmon_nl_msgpool *pool,
+                                        struct nlmon_msgpool_class_stats *stats,
+                                        size_t max);
+
 /**
  * nlmon_nl_msgpool_reset_stats() - Reset pool statistics
  * @pool: Pool handle
@@ -96,6 +125,22 @@ void nlmon_nl_msgpool_reset_stats(struct nlmon_nl_msgpool *pool);
  */
 int nlmon_nl_msgpool_resize(struct nlmon_nl_msgpool *pool, void *ptr, size_t new_size);
 
+/**
+ * nlmon_nl_msgpool_realloc() - Resize buffer, moving it if needed
+ * @pool: Pool handle
+ * @ptr: Buffer pointer, NULL to allocate
+ * @old_size: Bytes of @ptr to keep
+ * @new_size: New size
+ *
+ * A buffer stays in place while @new_size fits its class. Otherwise it
+ * moves to the class of @new_size (or the heap), copying @old_size bytes.
+ * Buffers not from the pool are passed to realloc().
+ *
+ * Returns: Buffer pointer, or NULL on error with @ptr left intact
+ */
+void *nlmon_nl_msgpool_realloc(struct nlmon_nl_msgpool *pool, void *ptr, size_t old_size,
+                               size_t new_size);
+
 /**
  * nlmon_nl_msgpool_get_capacity() - Get buffer capacity
  * @pool: Pool handle
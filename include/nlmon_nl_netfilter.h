@@ -1,7 +1,9 @@
 #ifndef NLMON_NL_NETFILTER_H
 #define NLMON_NL_NETFILTER_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -12,6 +14,35 @@ struct nlmsghdr;
 struct nlmon_event;
 struct nlmon_nl_manager;
 struct nl_msg;
+struct sock_filter;
+
+/* Conntrack events, each one a multicast group joined only when wanted */
+#define NLMON_CT_EVENT_NEW       (1u << 0)
+#define NLMON_CT_EVENT_UPDATE    (1u << 1)
+#define NLMON_CT_EVENT_DESTROY   (1u << 2)
+#define NLMON_CT_EVENT_ALL       (NLMON_CT_EVENT_NEW | NLMON_CT_EVENT_UPDATE | \
+                                  NLMON_CT_EVENT_DESTROY)
+
+/* Instructions nlmon_ct_filter_compile() may need */
+#define NLMON_CT_FILTER_MAX_INSNS 40
+
+/**
+ * Conntrack events to receive
+ *
+ * The event mask picks the multicast groups, the rest is compiled into a
+ * socket filter so other connections never leave the kernel. Conntrack
+ * leaves out the zone and mark attributes when they are 0, so a missing
+ * one matches 0.
+ */
+struct nlmon_ct_filter {
+	uint32_t events;                 /* NLMON_CT_EVENT_* mask, 0 for all */
+	uint8_t l3proto;                 /* AF_INET or AF_INET6, 0 for any */
+	uint8_t l4proto;                 /* IPPROTO_*, 0 for any */
+	bool match_zone;                 /* Only connections of @zone */
+	uint16_t zone;
+	uint32_t mark;                   /* Wanted value of mark & mark_mask */
+	uint32_t mark_mask;              /* 0 to ignore the mark */
+};
 
 /**
  * Connection tracking information structure
@@ -52,6 +83,35 @@ int nlmon_nf_msg_handler(struct nl_msg *msg, void *arg);
  */
 int nlmon_parse_conntrack_msg(struct nlmsghdr *nlh, struct nlmon_event *evt);
 
+/**
+ * Compile the connection part of a conntrack filter to classic BPF
+ *
+ * The program returns 0 for conntrack messages of other connections and
+ * falls through past its last instruction for the rest, other netfilter
+ * subsystems included, so it can be placed in front of another program.
+ *
+ * @param filter Filter
+ * @param insns Output for the program
+ * @param max Size of @insns, NLMON_CT_FILTER_MAX_INSNS is always enough
+ * @return Number of instructions, 0 if the filter takes every connection,
+ *         or -EINVAL / -ENOSPC
+ */
+int nlmon_ct_filter_compile(const struct nlmon_ct_filter *filter,
+                            struct sock_filter *insns, size_t max);
+
+/**
+ * Narrow the conntrack events received by a manager
+ *
+ * Applied to the NETLINK_NETFILTER socket at once if it is open, and
+ * again whenever it is (re)connected. The socket prefilter set with
+ * nlmon_nl_set_filter() still applies after this one.
+ *
+ * @param mgr Netlink manager
+ * @param filter Filter, NULL to receive every conntrack event
+ * @return 0 on success, negative error code on failure
+ */
+int nlmon_nl_set_ct_filter(struct nlmon_nl_manager *mgr, const struct nlmon_ct_filter *filter);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,160 @@
+/* nlmon_nl_netns.h - Netlink monitoring across network namespaces
+ *
+ * A netns set holds one netlink manager per network namespace, each
+ * with its sockets opened inside that namespace, and waits on all of
+ * them with a single epoll instance. Namespaces are attached and
+ * detached as the namespace tracker sees them come and go, and every
+ * event is tagged with the namespace it was received in, so thousands
+ * of namespaces cost file descriptors rather than threads.
+ *
+ * Entering a namespace needs CAP_SYS_ADMIN. A set is not synchronized,
+ * it is meant to be driven from one event loop thread.
+ */
+
+#ifndef NLMON_NL_NETNS_H
+#define NLMON_NL_NETNS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct nlmon_event;
+struct nlmon_nl_manager;
+struct namespace_tracker;
+struct nlmon_nl_netns_set;
+
+/**
+ * struct nlmon_nl_netns_config - Netns set configuration
+ * @enable_route: Open a NETLINK_ROUTE socket in each namespace
+ * @enable_genl: Open a NETLINK_GENERIC socket in each namespace
+ * @enable_diag: Open a NETLINK_SOCK_DIAG socket in each namespace
+ * @enable_netfilter: Open a NETLINK_NETFILTER socket in each namespace
+ * @include_current: Also monitor our own namespace, for callers without
+ *                   a manager of their own
+ * @event_callback: Called for each event, with netlink.netns set to the
+ *                  namespace inode (0 for our own namespace)
+ * @user_data: Passed to @event_callback and @setup
+ * @setup: Optional, called for each new manager before its sockets are
+ *         opened, to set prefilters or lazy decoding. A negative return
+ *         fails the attach.
+ */
+struct nlmon_nl_netns_config {
+	int enable_route;
+	int enable_genl;
+	int enable_diag;
+	int enable_netfilter;
+	int include_current;
+	void (*event_callback)(struct nlmon_event *evt, void *user_data);
+	void *user_data;
+	int (*setup)(struct nlmon_nl_manager *mgr, void *user_data);
+};
+
+/**
+ * struct nlmon_nl_netns_stats - Netns set counters
+ * @namespaces: Namespaces currently attached
+ * @attached: Attaches since creation
+ * @detached: Detaches since creation
+ * @attach_failed: Attaches that failed, including namespaces that went
+ *                 away while being entered
+ * @events: Events delivered
+ */
+struct nlmon_nl_netns_stats {
+	size_t namespaces;
+	uint64_t attached;
+	uint64_t detached;
+	uint64_t attach_failed;
+	uint64_t events;
+};
+
+/**
+ * nlmon_nl_netns_create() - Create an empty netns set
+ * @config: Configuration, copied
+ *
+ * Returns: Set, or NULL on error
+ */
+struct nlmon_nl_netns_set *nlmon_nl_netns_create(const struct nlmon_nl_netns_config *config);
+
+/**
+ * nlmon_nl_netns_destroy() - Detach all namespaces and free the set
+ * @set: Set (can be NULL)
+ */
+void nlmon_nl_netns_destroy(struct nlmon_nl_netns_set *set);
+
+/**
+ * nlmon_nl_netns_attach() - Monitor the namespace behind a path
+ * @set: Set
+ * @path: Namespace file, such as /var/run/netns/<name> or
+ *        /proc/<pid>/ns/net
+ * @name: Name reported by nlmon_nl_netns_name() (can be NULL)
+ *
+ * Returns: 0 on success or if the namespace is already attached,
+ *          negative error code on failure
+ */
+int nlmon_nl_netns_attach(struct nlmon_nl_netns_set *set, const char *path,
+                          const char *name);
+
+/**
+ * nlmon_nl_netns_detach() - Stop monitoring a namespace
+ * @set: Set
+ * @ino: Namespace inode
+ *
+ * Closes the namespace's sockets, which also lets the kernel free a
+ * namespace that nothing else holds.
+ *
+ * Returns: 0 on success, -ENOENT if the namespace is not attached
+ */
+int nlmon_nl_netns_detach(struct nlmon_nl_netns_set *set, uint64_t ino);
+
+/**
+ * nlmon_nl_netns_sync() - Match the set to the tracked namespaces
+ * @set: Set
+ * @tracker: Namespace tracker
+ *
+ * Attaches namespaces the tracker knows and the set does not, detaches
+ * the ones the tracker no longer knows, and reattaches namespaces whose
+ * sockets could not be reconnected. Call it when the tracker's fd is
+ * readable and periodically.
+ *
+ * Returns: Number of namespaces attached after the sync, or negative
+ *          error code
+ */
+int nlmon_nl_netns_sync(struct nlmon_nl_netns_set *set, struct namespace_tracker *tracker);
+
+/**
+ * nlmon_nl_netns_get_fd() - Epoll fd of the set
+ * @set: Set
+ *
+ * Readable when any namespace has messages, for adding to an outer loop.
+ *
+ * Returns: The fd, or -1 if @set is NULL
+ */
+int nlmon_nl_netns_get_fd(struct nlmon_nl_netns_set *set);
+
+/**
+ * nlmon_nl_netns_process() - Receive from the ready sockets
+ * @set: Set
+ * @timeout_ms: Time to wait for a ready socket, 0 to only poll, -1 to
+ *              wait indefinitely
+ *
+ * Returns: Number of sockets processed, or negative error code
+ */
+int nlmon_nl_netns_process(struct nlmon_nl_netns_set *set, int timeout_ms);
+
+/**
+ * nlmon_nl_netns_name() - Name of an attached namespace
+ * @set: Set
+ * @ino: Namespace inode
+ * @buf: Output buffer
+ * @len: Size of @buf
+ *
+ * Returns: 0 on success, -ENOENT if the namespace is not attached
+ */
+int nlmon_nl_netns_name(struct nlmon_nl_netns_set *set, uint64_t ino, char *buf, size_t len);
+
+/**
+ * nlmon_nl_netns_get_stats() - Counters of the set
+ * @set: Set
+ * @stats: Output
+ */
+void nlmon_nl_netns_get_stats(struct nlmon_nl_netns_set *set, struct nlmon_nl_netns_stats *stats);
+
+#endif /* NLMON_NL_NETNS_H */
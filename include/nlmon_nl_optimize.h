@@ -158,5 +158,155 @@ int nlmon_iterate_messages_optimized(void *buf, size_t len,
                                     int (*handler)(struct nlmsghdr *, void *),
                                     void *user_data);
 
+/**
+ * Attribute decode kinds
+ *
+ * Integer kinds name the wire width and byte order; the value is stored
+ * with the width of the destination field. Address kinds are formatted
+ * with inet_ntop() into a string field.
+ */
+enum nlmon_nl_attr_kind {
+	NLMON_NL_ATTR_NONE = 0,          /* Not decoded */
+	NLMON_NL_ATTR_U8,
+	NLMON_NL_ATTR_U16,
+	NLMON_NL_ATTR_U32,
+	NLMON_NL_ATTR_U64,
+	NLMON_NL_ATTR_BE16,
+	NLMON_NL_ATTR_BE32,
+	NLMON_NL_ATTR_BE64,
+	NLMON_NL_ATTR_STRING,            /* NUL terminated, truncated to field */
+	NLMON_NL_ATTR_BINARY,            /* Copied if it fits the field */
+	NLMON_NL_ATTR_ADDR,              /* Address of the message's family */
+	NLMON_NL_ATTR_ADDR4,             /* IPv4 address */
+	NLMON_NL_ATTR_ADDR6,             /* IPv6 address */
+	NLMON_NL_ATTR_NESTED             /* Decoded with a nested table */
+};
+
+struct nlmon_nl_attr_table;
+
+/**
+ * struct nlmon_nl_attr_desc - How one attribute type is decoded
+ * @offset: Offset of the destination field in the output structure
+ *          (relative to the parent's offset for nested attributes)
+ * @size: Size of the destination field
+ * @kind: enum nlmon_nl_attr_kind
+ * @nested: Table of the nested attributes for NLMON_NL_ATTR_NESTED
+ */
+struct nlmon_nl_attr_desc {
+	uint16_t offset;
+	uint8_t size;
+	uint8_t kind;
+	const struct nlmon_nl_attr_table *nested;
+};
+
+/**
+ * struct nlmon_nl_attr_table - Descriptors indexed by attribute type
+ * @desc: Descriptor array with @maxtype + 1 entries
+ * @maxtype: Highest attribute type described
+ */
+struct nlmon_nl_attr_table {
+	const struct nlmon_nl_attr_desc *desc;
+	uint16_t maxtype;
+};
+
+/**
+ * struct nlmon_nl_hdr_desc - How one family header field is copied
+ * @src: Offset of the field in the family header
+ * @src_size: Size of the header field (1, 2 or 4)
+ * @dst: Offset of the destination field in the output structure
+ * @dst_size: Size of the destination field (1, 2 or 4)
+ */
+struct nlmon_nl_hdr_desc {
+	uint16_t src;
+	uint8_t src_size;
+	uint16_t dst;
+	uint8_t dst_size;
+};
+
+/**
+ * struct nlmon_nl_decode_table - Complete decoder for one message class
+ * @hdrlen: Length of the family header (the address family is its first byte)
+ * @hdr: Header fields to copy
+ * @nhdr: Number of entries in @hdr
+ * @attrs: Top-level attribute table
+ * @out_size: Size of the output structure
+ * @finish: Optional fixup run after decoding (e.g. name fallbacks), or NULL
+ */
+struct nlmon_nl_decode_table {
+	uint16_t hdrlen;
+	const struct nlmon_nl_hdr_desc *hdr;
+	uint8_t nhdr;
+	struct nlmon_nl_attr_table attrs;
+	size_t out_size;
+	void (*finish)(const struct nlmsghdr *nlh, void *out);
+};
+
+/* Descriptor initializers, e.g. [IFLA_MTU] = NL_ATTR(struct nlmon_link_info,
+ * mtu, NLMON_NL_ATTR_U32) */
+#define NL_FIELD(type, field) \
+	offsetof(type, field), sizeof(((type *)0)->field)
+
+#define NL_ATTR(type, field, k) \
+	{ .offset = offsetof(type, field), .size = sizeof(((type *)0)->field), .kind = (k) }
+
+#define NL_NEST(type, field, table) \
+	{ .offset = offsetof(type, field), .kind = NLMON_NL_ATTR_NESTED, .nested = (table) }
+
+#define NL_HDR(hdr, hfield, type, field) \
+	{ offsetof(hdr, hfield), sizeof(((hdr *)0)->hfield), NL_FIELD(type, field) }
+
+#define NL_TABLE(desc) \
+	{ (desc), (uint16_t)(sizeof(desc) / sizeof((desc)[0]) - 1) }
+
+/* Decoders filling struct nlmon_link_info, nlmon_addr_info, nlmon_route_info,
+ * nlmon_neigh_info and nlmon_ct_info respectively */
+extern const struct nlmon_nl_decode_table nlmon_nl_link_decoder;
+extern const struct nlmon_nl_decode_table nlmon_nl_addr_decoder;
+extern const struct nlmon_nl_decode_table nlmon_nl_route_decoder;
+extern const struct nlmon_nl_decode_table nlmon_nl_neigh_decoder;
+extern const struct nlmon_nl_decode_table nlmon_nl_ct_decoder;
+
+/**
+ * nlmon_nl_decoder_lookup() - Find the decoder of a message type
+ * @protocol: Netlink protocol (NETLINK_ROUTE or NETLINK_NETFILTER)
+ * @msg_type: Netlink message type
+ *
+ * Returns: Decode table, or NULL if the message type has none
+ */
+const struct nlmon_nl_decode_table *nlmon_nl_decoder_lookup(int protocol, uint16_t msg_type);
+
+/**
+ * nlmon_nl_table_decode() - Table-driven message decoder
+ * @table: Decode table of the message class
+ * @nlh: Netlink message header
+ * @out: Output structure of @table->out_size bytes, cleared first
+ *
+ * Copies the family header fields and walks the attributes once,
+ * storing each described type straight into its field of @out. Nested
+ * attributes are walked with their own tables. As with nlmsg_parse(),
+ * the last occurrence of a type wins. Attributes too short for their
+ * kind are ignored.
+ *
+ * Returns: 0 on success, negative error code on failure
+ */
+int nlmon_nl_table_decode(const struct nlmon_nl_decode_table *table,
+                         struct nlmsghdr *nlh, void *out);
+
+/**
+ * nlmon_nl_attrs_decode() - Table-driven attribute stream decoder
+ * @table: Attribute table
+ * @head: First attribute, e.g. the payload of a nested attribute
+ * @len: Length of the attribute stream
+ * @out: Output structure, not cleared
+ *
+ * Decodes a bare attribute stream the way nlmon_nl_table_decode() does
+ * the attributes of a message. Types above @table->maxtype or described
+ * as NLMON_NL_ATTR_NONE are skipped by their length without being
+ * looked at. NLMON_NL_ATTR_ADDR attributes are ignored, as the stream
+ * has no address family.
+ */
+void nlmon_nl_attrs_decode(const struct nlmon_nl_attr_table *table,
+                           struct nlattr *head, int len, void *out);
+
 #endif /* NLMON_NL_OPTIMIZE_H */
 
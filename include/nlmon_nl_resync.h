@@ -0,0 +1,142 @@
+#ifndef NLMON_NL_RESYNC_H
+#define NLMON_NL_RESYNC_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Forward declarations */
+struct nlmon_event;
+struct nlmon_nl_manager;
+
+/* Opaque last-known NETLINK_ROUTE object state */
+struct nlmon_nl_state;
+
+/**
+ * Object classes tracked for resynchronization
+ */
+enum nlmon_nl_state_kind {
+	NLMON_NL_STATE_LINK = 0,
+	NLMON_NL_STATE_ADDR,
+	NLMON_NL_STATE_ROUTE,
+	NLMON_NL_STATE_KIND_COUNT
+};
+
+/* Masks selecting the object classes to resynchronize */
+#define NLMON_NL_RESYNC_LINK   (1u << NLMON_NL_STATE_LINK)
+#define NLMON_NL_RESYNC_ADDR   (1u << NLMON_NL_STATE_ADDR)
+#define NLMON_NL_RESYNC_ROUTE  (1u << NLMON_NL_STATE_ROUTE)
+#define NLMON_NL_RESYNC_ALL    (NLMON_NL_RESYNC_LINK | NLMON_NL_RESYNC_ADDR | \
+                                NLMON_NL_RESYNC_ROUTE)
+
+/**
+ * Resynchronization statistics
+ */
+struct nlmon_nl_resync_stats {
+	uint64_t overruns;               /* ENOBUFS overruns detected (all protocols) */
+	uint64_t route_overruns;         /* NETLINK_ROUTE overruns */
+	uint64_t genl_overruns;          /* NETLINK_GENERIC overruns */
+	uint64_t diag_overruns;          /* NETLINK_SOCK_DIAG overruns */
+	uint64_t nf_overruns;            /* NETLINK_NETFILTER overruns */
+	uint64_t resyncs;                /* Completed resynchronizations */
+	uint64_t resync_failures;        /* Failed or interrupted resynchronizations */
+	uint64_t delta_events;           /* Synthetic delta events emitted */
+	uint64_t objects;                /* Objects currently tracked */
+};
+
+/**
+ * Create state table
+ *
+ * @return State table, or NULL on allocation failure
+ */
+struct nlmon_nl_state *nlmon_nl_state_create(void);
+
+/**
+ * Destroy state table
+ *
+ * @param state State table
+ */
+void nlmon_nl_state_destroy(struct nlmon_nl_state *state);
+
+/**
+ * Apply a live NETLINK_ROUTE event to the state table
+ *
+ * NEW events insert or replace the object, DEL events remove it.
+ * Events of untracked types are ignored.
+ *
+ * @param state State table
+ * @param evt Parsed event
+ */
+void nlmon_nl_state_apply(struct nlmon_nl_state *state, const struct nlmon_event *evt);
+
+/**
+ * Get number of objects in the state table
+ *
+ * @param state State table
+ * @return Number of tracked objects
+ */
+uint64_t nlmon_nl_state_count(struct nlmon_nl_state *state);
+
+/**
+ * Enable ENOBUFS-aware resynchronization
+ *
+ * Creates the state table and seeds it with a silent dump of all links,
+ * addresses and routes. Once enabled, a receive buffer overrun on
+ * NETLINK_ROUTE triggers nlmon_nl_resync() and only the differences
+ * against the last known state are emitted. Requires NETLINK_ROUTE.
+ *
+ * @param mgr Netlink manager
+ * @return 0 on success, negative error code on failure
+ */
+int nlmon_nl_enable_resync(struct nlmon_nl_manager *mgr);
+
+/**
+ * Disable resynchronization and free the state table
+ *
+ * @param mgr Netlink manager
+ */
+void nlmon_nl_disable_resync(struct nlmon_nl_manager *mgr);
+
+/**
+ * Resynchronize NETLINK_ROUTE state
+ *
+ * Dumps the requested object classes over a private socket, diffs them
+ * against the state table and passes synthetic RTM_NEW* events for new
+ * or changed objects and RTM_DEL* events for vanished objects to the
+ * manager's event callback. Unchanged objects produce no events.
+ *
+ * @param mgr Netlink manager with resync enabled
+ * @param mask NLMON_NL_RESYNC_* classes to resynchronize
+ * @return Number of delta events emitted, or negative error code
+ */
+int nlmon_nl_resync(struct nlmon_nl_manager *mgr, unsigned int mask);
+
+/**
+ * Handle a receive buffer overrun on a manager socket
+ *
+ * Accounts the overrun (including nlmon_nl_limits socket buffer stats if
+ * a limits tracker is attached) and resynchronizes the affected
+ * protocol's state where a dump is available.
+ *
+ * @param mgr Netlink manager
+ * @param protocol Protocol whose socket returned ENOBUFS
+ * @return 0 on success, negative error code if resynchronization failed
+ */
+int nlmon_nl_handle_overrun(struct nlmon_nl_manager *mgr, int protocol);
+
+/**
+ * Get resynchronization statistics
+ *
+ * @param mgr Netlink manager
+ * @param stats Output for statistics
+ */
+void nlmon_nl_get_resync_stats(struct nlmon_nl_manager *mgr,
+                               struct nlmon_nl_resync_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NLMON_NL_RESYNC_H */
@@ -5,6 +5,10 @@
 #include <net/if.h>
 #include <linux/if_ether.h>
 
+#include <netlink/attr.h>
+
+#include "event_processor.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -14,6 +18,7 @@ struct nlmsghdr;
 struct nlmon_event;
 struct nlmon_nl_manager;
 struct nl_msg;
+struct nlattr;
 
 /**
  * Link (interface) information structure
@@ -56,6 +61,7 @@ struct nlmon_route_info {
 	char gateway[64];                /* Gateway address */
 	int oif;                         /* Output interface */
 	unsigned int priority;           /* Route priority */
+	unsigned int table;              /* Routing table, RTA_TABLE if present */
 };
 
 /**
@@ -70,6 +76,32 @@ struct nlmon_neigh_info {
 	unsigned char lladdr[ETH_ALEN];  /* Link-layer address */
 };
 
+/* Attribute types covered by the lazy decode index */
+#define NLMON_NL_ATTR_INDEX_SIZE 32
+
+/**
+ * Compact attribute index over one NETLINK_ROUTE message
+ * 
+ * Presence bitmap and offsets of the attribute types below
+ * NLMON_NL_ATTR_INDEX_SIZE, filled by nlmsg_parse_index().
+ */
+struct nlmon_nl_attr_index {
+	uint16_t hdrlen;                          /* Family header length */
+	NLA_INDEX(NLMON_NL_ATTR_INDEX_SIZE - 1) attrs;
+};
+
+/**
+ * Deferred decode state of a NETLINK_ROUTE event
+ * 
+ * Lives with the event for the duration of the manager callback and
+ * references the message in the receive buffer.
+ */
+struct nlmon_nl_route_lazy {
+	struct nlmon_event_lazy base;
+	struct nlmsghdr *nlh;
+	struct nlmon_nl_attr_index index;
+};
+
 /**
  * Route message callback handler
  * 
@@ -117,6 +149,43 @@ int nlmon_parse_route_msg(struct nlmsghdr *nlh, struct nlmon_event *evt);
  */
 int nlmon_parse_neigh_msg(struct nlmsghdr *nlh, struct nlmon_event *evt);
 
+/**
+ * Build the attribute index of a link, address, route or neighbor message
+ * 
+ * A single walk over the attributes, with the same validation as the
+ * eager parsers but without decoding anything.
+ * 
+ * @param nlh Netlink message header
+ * @param index Index to fill
+ * @return 0 on success, negative error code on failure
+ */
+int nlmon_nl_index_route_msg(struct nlmsghdr *nlh, struct nlmon_nl_attr_index *index);
+
+/**
+ * Look up an attribute through the index
+ * 
+ * @param nlh Indexed message
+ * @param index Attribute index
+ * @param type Attribute type
+ * @return Attribute, or NULL if absent or not indexed
+ */
+struct nlattr *nlmon_nl_index_attr(struct nlmsghdr *nlh,
+                                   const struct nlmon_nl_attr_index *index, int type);
+
+/**
+ * Defer decoding of a link, address, route or neighbor message
+ * 
+ * Indexes the message and attaches @lazy to the event. netlink.data and
+ * interface are filled on the first nlmon_event_materialize() call.
+ * 
+ * @param nlh Netlink message header, must stay valid until materialized
+ * @param evt Event structure
+ * @param lazy Decode state, must outlive the event's delivery
+ * @return 0 on success, negative error code on failure
+ */
+int nlmon_defer_route_msg(struct nlmsghdr *nlh, struct nlmon_event *evt,
+                          struct nlmon_nl_route_lazy *lazy);
+
 #ifdef __cplusplus
 }
 #endif
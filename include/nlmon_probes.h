@@ -0,0 +1,43 @@
+/* nlmon_probes.h - Static tracepoints on the event pipeline
+ *
+ * With ENABLE_USDT the probes are SystemTap SDT markers in the "nlmon"
+ * provider: a nop at the probe site plus a note in the binary that
+ * bpftrace, perf and SystemTap read, so a running nlmon can be traced
+ * without rebuilding or restarting it, e.g.
+ *
+ *   bpftrace -e 'usdt:./nlmon:nlmon:storage_insert_done { @[arg1] = count(); }'
+ *
+ * Without it they compile to nothing and their arguments are not
+ * evaluated.
+ *
+ * Probes and their arguments:
+ *   nl_recv(msg_type, msg_len)                     message taken from a socket
+ *   event_submit(event_type, sequence, lane)       event queued
+ *   dispatch_start(count) / dispatch_done(count)   batch handed to handlers
+ *   filter_start(event_type) / filter_done(match)  filter expression run
+ *   storage_insert_start(sequence) / storage_insert_done(sequence, ok)
+ *   export_start(target, sequence) / export_done(target, ok)
+ *   hook_start(event_type) / hook_done(event_type) hooks run for an event
+ *   alert_fire(rule_id, rule_name, sequence)       rule triggered
+ *   alert_send(rule_id, count, ok)                 digest delivered
+ */
+
+#ifndef NLMON_PROBES_H
+#define NLMON_PROBES_H
+
+#if defined(ENABLE_USDT) && ENABLE_USDT
+#include <sys/sdt.h>
+
+#define NLMON_PROBE1(name, a) \
+	DTRACE_PROBE1(nlmon, name, a)
+#define NLMON_PROBE2(name, a, b) \
+	DTRACE_PROBE2(nlmon, name, a, b)
+#define NLMON_PROBE3(name, a, b, c) \
+	DTRACE_PROBE3(nlmon, name, a, b, c)
+#else
+#define NLMON_PROBE1(name, a) do { } while (0)
+#define NLMON_PROBE2(name, a, b) do { } while (0)
+#define NLMON_PROBE3(name, a, b, c) do { } while (0)
+#endif
+
+#endif /* NLMON_PROBES_H */
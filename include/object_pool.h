@@ -2,6 +2,11 @@
  *
  * Provides efficient object pooling with configurable size and statistics.
  * Reduces allocation overhead and memory fragmentation.
+ *
+ * Objects live in one slab. Each thread allocates from and frees to its
+ * own cache of two magazines, which exchange full and empty magazines
+ * with a lock-free global depot, so objects allocated on one thread and
+ * freed on another only meet in the depot once per magazine.
  */
 
 #ifndef OBJECT_POOL_H
@@ -10,6 +15,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <sys/types.h>
 
 /* Object pool structure (opaque) */
 struct object_pool;
@@ -23,6 +29,28 @@ struct object_pool_stats {
 	unsigned long total_frees;    /* Total frees */
 	unsigned long pool_hits;      /* Allocations from pool */
 	unsigned long pool_misses;    /* Allocations from heap */
+	unsigned long cache_hits;     /* Pool allocations served by a thread cache */
+	unsigned long depot_refills;  /* Magazines taken from the depot */
+	unsigned long depot_flushes;  /* Magazines returned to the depot */
+	bool hugepages;               /* Slab is backed by huge pages */
+};
+
+/* Object pool statistics of one thread */
+struct object_pool_thread_stats {
+	pid_t tid;                    /* Kernel thread ID */
+	unsigned long allocs;         /* Allocations by the thread */
+	unsigned long frees;          /* Frees by the thread */
+	unsigned long cache_hits;     /* Allocations served by its cache */
+	unsigned long depot_refills;  /* Magazines it took from the depot */
+	unsigned long depot_flushes;  /* Magazines it returned to the depot */
+};
+
+/* Object pool creation options */
+struct object_pool_options {
+	size_t object_size;       /* Size of each object in bytes */
+	size_t capacity;          /* Objects kept in the slab */
+	size_t magazine_size;     /* Objects per thread cache magazine (0=32) */
+	bool hugepages;           /* Back the slab with huge pages where possible */
 };
 
 /**
@@ -34,6 +62,19 @@ struct object_pool_stats {
  */
 struct object_pool *object_pool_create(size_t object_size, size_t capacity);
 
+/**
+ * object_pool_create_opts() - Create object pool with options
+ * @opts: Creation options
+ *
+ * With hugepages set the slab is taken from reserved huge pages, else
+ * transparent huge pages are requested for it. Without either the pool
+ * works as usual, object_pool_get_stats() reports what was obtained.
+ * Without it, large slabs follow the huge_alloc.h configuration.
+ *
+ * Returns: Pointer to object pool or NULL on error
+ */
+struct object_pool *object_pool_create_opts(const struct object_pool_options *opts);
+
 /**
  * object_pool_destroy() - Destroy object pool
  * @pool: Object pool
@@ -67,6 +108,21 @@ void object_pool_free(struct object_pool *pool, void *obj);
  */
 void object_pool_get_stats(struct object_pool *pool, struct object_pool_stats *stats);
 
+/**
+ * object_pool_get_thread_stats() - Get per-thread statistics
+ * @pool: Object pool
+ * @stats: Output array, may be NULL if @max is 0
+ * @max: Number of entries in @stats
+ *
+ * Threads that exited are folded into the pool totals and not listed.
+ * Threads beyond the per-thread cache limit share the pool totals too.
+ *
+ * Returns: Number of threads with a cache, at most @max entries filled
+ */
+size_t object_pool_get_thread_stats(struct object_pool *pool,
+                                    struct object_pool_thread_stats *stats,
+                                    size_t max);
+
 /**
  * object_pool_reset_stats() - Reset statistics counters
  * @pool: Object pool
@@ -0,0 +1,168 @@
+/* otlp_export.h - OpenTelemetry (OTLP/HTTP) log and metric exporter
+ *
+ * Events become OTLP log records, collected into batches that are sent
+ * to a collector as ExportLogsServiceRequest messages, protobuf encoded
+ * and gzipped, over HTTP. Metrics of a Prometheus exporter and a
+ * resource tracker are sent the same way every metrics interval, as
+ * cumulative sums, gauges, histograms and summaries.
+ *
+ * The exporter does its work, sending included, on the thread that calls
+ * it, in nlmon the export layer's worker. Requests that fail in a way the
+ * OTLP specification calls retryable (no connection, 429, 502, 503, 504)
+ * are kept and sent again with exponential backoff, later requests
+ * waiting behind them; other failures are counted and dropped.
+ */
+
+#ifndef OTLP_EXPORT_H
+#define OTLP_EXPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Forward declarations */
+struct nlmon_event;
+struct prometheus_exporter;
+struct resource_tracker;
+
+#define OTLP_DEFAULT_ENDPOINT "http://localhost:4318"
+#define OTLP_BATCH_EVENTS 512                   /* Log records per request */
+#define OTLP_BATCH_BYTES (512 * 1024)           /* Encoded bytes per request */
+#define OTLP_BATCH_DELAY_MS 1000                /* Oldest record a batch waits with */
+#define OTLP_METRICS_INTERVAL_MS 10000
+#define OTLP_TIMEOUT_MS 10000                   /* Per request */
+#define OTLP_RETRY_INITIAL_MS 500
+#define OTLP_RETRY_MAX_MS 30000                 /* Longest wait between attempts */
+#define OTLP_RETRY_ELAPSED_MS 300000            /* Time a request is retried for */
+#define OTLP_MEMORY_DEFAULT (8 * 1024 * 1024)   /* Bytes of requests waiting */
+
+/* OTLP exporter configuration, zero fields take the defaults */
+struct otlp_config {
+	const char *endpoint;           /* Base URL, /v1/logs and /v1/metrics are appended */
+	const char *headers;            /* "name=value,..." as OTEL_EXPORTER_OTLP_HEADERS, or NULL */
+	const char *service_name;       /* service.name, "nlmon" by default */
+	const char *node;               /* host.name, NULL for the hostname */
+	int level;                      /* gzip level, 0 for 1 (fastest), -1 to not compress */
+	unsigned int batch_events;      /* Most records per request */
+	size_t batch_bytes;
+	unsigned int batch_delay_ms;    /* Longest a record waits for more */
+	unsigned int batch_latency_ms;  /* Delivery latency aimed for, 0 for 2 * batch_delay_ms */
+	unsigned int timeout_ms;
+	unsigned int retry_initial_ms;
+	unsigned int retry_max_ms;
+	unsigned int retry_elapsed_ms;
+	size_t memory_limit;            /* Oldest requests are dropped beyond it */
+	
+	/* Metric sources, each optional */
+	struct prometheus_exporter *prometheus;
+	struct resource_tracker *resource_tracker;
+	unsigned int metrics_interval_ms;
+};
+
+/* OTLP exporter statistics */
+struct otlp_stats {
+	uint64_t events;                /* Log records batched */
+	uint64_t requests;              /* Requests sent successfully */
+	uint64_t metric_points;         /* Data points in successful requests */
+	uint64_t bytes_sent;            /* Request bodies, retries included */
+	uint64_t retries;               /* Attempts after a retryable failure */
+	uint64_t failed;                /* Requests given up on */
+	uint64_t dropped;               /* Log records lost with them or to the memory limit */
+	uint32_t pending;               /* Requests waiting to be sent */
+	size_t pending_bytes;
+};
+
+/* A metric data point, as the sources hand them to the encoder */
+enum otlp_metric_kind {
+	OTLP_METRIC_SUM,                /* Monotonic cumulative counter */
+	OTLP_METRIC_GAUGE,
+	OTLP_METRIC_HISTOGRAM,          /* Cumulative, explicit bounds */
+	OTLP_METRIC_SUMMARY
+};
+
+struct otlp_metric {
+	const char *name;
+	const char *labels;             /* Prometheus style name="value",... or "" */
+	enum otlp_metric_kind kind;
+	double value;                   /* Sum or gauge */
+	uint64_t count;                 /* Histogram and summary observations */
+	double sum;
+	const double *bounds;           /* Histogram bucket upper bounds, nbuckets - 1 of them */
+	const uint64_t *buckets;        /* Observations per bucket, not cumulative */
+	unsigned int nbuckets;
+	const double *quantiles;        /* Summary quantiles and their values */
+	const double *quantile_values;
+	unsigned int nquantiles;
+};
+
+typedef void (*otlp_metric_fn)(const struct otlp_metric *metric, void *ctx);
+
+/* OTLP exporter handle (opaque) */
+struct otlp_exporter;
+
+/**
+ * otlp_exporter_create() - Create an OTLP exporter
+ * @config: Configuration
+ *
+ * Returns: OTLP exporter handle or NULL on error
+ */
+struct otlp_exporter *otlp_exporter_create(const struct otlp_config *config);
+
+/**
+ * otlp_exporter_destroy() - Send the current batch once and destroy the exporter
+ * @exporter: OTLP exporter handle
+ *
+ * Requests still waiting for a retry are dropped.
+ */
+void otlp_exporter_destroy(struct otlp_exporter *exporter);
+
+/**
+ * otlp_exporter_write_event() - Add an event to the current batch as a log record
+ * @exporter: OTLP exporter handle
+ * @event: Event
+ *
+ * A full batch is sent at once, then whatever otlp_exporter_tick() would.
+ *
+ * Returns: true if batched, false on error
+ */
+bool otlp_exporter_write_event(struct otlp_exporter *exporter, const struct nlmon_event *event);
+
+/**
+ * otlp_exporter_tick() - Do what is due
+ * @exporter: OTLP exporter handle
+ *
+ * Sends the batch once it is older than the batch delay, requests whose
+ * backoff has passed and metrics every metrics interval. Call it every
+ * few hundred milliseconds while events are not coming.
+ */
+void otlp_exporter_tick(struct otlp_exporter *exporter);
+
+/**
+ * otlp_exporter_flush() - Send the current batch and the waiting requests
+ * @exporter: OTLP exporter handle
+ *
+ * Requests waiting for a backoff are tried now, once.
+ *
+ * Returns: true if nothing is left unsent, false otherwise
+ */
+bool otlp_exporter_flush(struct otlp_exporter *exporter);
+
+/**
+ * otlp_exporter_get_stats() - Get exporter statistics
+ * @exporter: OTLP exporter handle
+ * @stats: Output
+ *
+ * Safe to call from any thread.
+ */
+void otlp_exporter_get_stats(struct otlp_exporter *exporter, struct otlp_stats *stats);
+
+/**
+ * otlp_resource_tracker_metrics() - Hand the metrics of a resource tracker on
+ * @tracker: Resource tracker
+ * @fn: Called for each metric
+ * @ctx: Context for @fn
+ */
+void otlp_resource_tracker_metrics(struct resource_tracker *tracker, otlp_metric_fn fn,
+                                   void *ctx);
+
+#endif /* OTLP_EXPORT_H */
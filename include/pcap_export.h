@@ -1,7 +1,12 @@
 /* pcap_export.h - Enhanced PCAP export with rotation support
  *
  * Provides PCAP file export with automatic rotation based on size
- * and configurable rotation policies.
+ * and configurable rotation policies. Files are classic pcap or
+ * pcapng; pcapng files give each interface its own Interface
+ * Description Block and carry a comment with every packet.
+ *
+ * Records collect in a buffer that is written out when full or on
+ * flush, optionally with O_DIRECT for long captures.
  */
 
 #ifndef PCAP_EXPORT_H
@@ -17,6 +22,34 @@ struct pcap_rotation_policy {
 	size_t max_file_size;      /* Maximum file size before rotation (bytes) */
 	size_t max_rotations;      /* Maximum number of rotated files to keep */
 	bool compress_rotated;     /* Compress rotated files with gzip */
+	int compress_level;        /* gzip level 1-9, 0 for the default */
+	int compress_threads;      /* Compression threads, 0 for one */
+};
+
+/* Capture file formats */
+enum pcap_format {
+	PCAP_FORMAT_PCAP,          /* Classic pcap, microsecond timestamps */
+	PCAP_FORMAT_PCAPNG         /* pcapng, nanosecond timestamps */
+};
+
+/* Default bytes of records buffered per write */
+#define PCAP_EXPORT_BUFFER_SIZE (1024 * 1024)
+
+/* Most interfaces of one pcapng file, later ones share the first */
+#define PCAP_MAX_INTERFACES 64
+
+/* PCAP output options */
+struct pcap_export_options {
+	enum pcap_format format;
+	size_t buffer_size;        /* Bytes buffered per write, 0 for default */
+	bool direct_io;            /* Write whole blocks with O_DIRECT where supported */
+};
+
+/* Packet metadata */
+struct pcap_packet_info {
+	uint64_t timestamp_ns;     /* Capture time since the epoch, 0 for now */
+	const char *interface;     /* Interface name, NULL for the nlmon interface */
+	const char *comment;       /* Annotation, pcapng only (NULL for none) */
 };
 
 /* PCAP exporter handle (opaque) */
@@ -32,6 +65,18 @@ struct pcap_exporter;
 struct pcap_exporter *pcap_exporter_create(const char *base_filename,
                                            struct pcap_rotation_policy *policy);
 
+/**
+ * pcap_exporter_create_with_options() - Create PCAP exporter
+ * @base_filename: Base filename for PCAP files
+ * @policy: Rotation policy (NULL for no rotation)
+ * @options: Output options (NULL for classic pcap, as pcap_exporter_create())
+ *
+ * Returns: PCAP exporter handle or NULL on error
+ */
+struct pcap_exporter *pcap_exporter_create_with_options(const char *base_filename,
+                                                        struct pcap_rotation_policy *policy,
+                                                        const struct pcap_export_options *options);
+
 /**
  * pcap_exporter_destroy() - Destroy PCAP exporter
  * @exporter: PCAP exporter handle
@@ -50,6 +95,23 @@ bool pcap_exporter_write_packet(struct pcap_exporter *exporter,
                                 const unsigned char *data,
                                 size_t len);
 
+/**
+ * pcap_exporter_write_packet_info() - Write packet with metadata
+ * @exporter: PCAP exporter handle
+ * @data: Packet data
+ * @len: Packet length
+ * @info: Packet metadata (NULL for none)
+ *
+ * In pcapng files the first packet of each interface name adds an
+ * Interface Description Block for it.
+ *
+ * Returns: true on success, false on error
+ */
+bool pcap_exporter_write_packet_info(struct pcap_exporter *exporter,
+                                     const unsigned char *data,
+                                     size_t len,
+                                     const struct pcap_packet_info *info);
+
 /**
  * pcap_exporter_flush() - Flush pending writes
  * @exporter: PCAP exporter handle
@@ -2,6 +2,12 @@
  *
  * Provides event processing time measurement, bottleneck detection,
  * and profiling data export capabilities.
+ *
+ * Hot paths register their operations once and time them with probes:
+ * each thread writes samples to its own ring, in ticks of the CPU's
+ * counter, and a background aggregator converts and merges them. The
+ * statistics readers merge whatever is pending first, so they are
+ * current to the call.
  */
 
 #ifndef PERFORMANCE_PROFILER_H
@@ -12,6 +18,9 @@
 #include <stdbool.h>
 #include <time.h>
 #include <sys/types.h>
+#include "event_trace.h"
+
+struct stack_profile;
 
 /* Profiling sample structure */
 struct profile_sample {
@@ -42,15 +51,34 @@ struct bottleneck_info {
 	double avg_time_ms;
 	double percentage_of_total;
 	uint64_t sample_count;
+	double cpu_percentage;       /* Of the attached stack samples, -1 without */
 	bool is_bottleneck;
 };
 
+/* Latency from receipt to one pipeline stage of traced events */
+struct trace_stage_stats {
+	uint64_t count;
+	double p50_ms;
+	double p95_ms;
+	double p99_ms;
+	double max_ms;
+	uint64_t slow_count;  /* Count exceeding the slow threshold */
+};
+
+/* Event tracing statistics */
+struct trace_stats {
+	uint64_t traced;      /* Events reported after their handlers */
+	uint64_t sampled;     /* Of which sampled */
+	uint64_t outliers;    /* Of which slower than the threshold end to end */
+	struct trace_stage_stats stages[NLMON_TRACE_STAGES];
+};
+
 /* Performance profiler handle (opaque) */
 struct performance_profiler;
 
 /**
  * performance_profiler_create() - Create performance profiler
- * @max_samples: Maximum number of samples to keep (0 for default)
+ * @max_samples: Maximum number of _start() timings in progress (0 for default)
  * @slow_threshold_ms: Threshold for "slow" operations in milliseconds
  *
  * Returns: Performance profiler handle or NULL on error
@@ -64,6 +92,58 @@ struct performance_profiler *performance_profiler_create(size_t max_samples,
  */
 void performance_profiler_destroy(struct performance_profiler *profiler);
 
+/**
+ * performance_profiler_ticks() - Read the probe clock
+ *
+ * The TSC on x86, the virtual counter on arm64, nanoseconds of
+ * CLOCK_MONOTONIC elsewhere. Only differences mean anything, and are
+ * converted at a rate the profiler calibrates against CLOCK_MONOTONIC.
+ *
+ * Returns: Tick count
+ */
+static inline uint64_t performance_profiler_ticks(void)
+{
+	return nlmon_clock_cycles();
+}
+
+/**
+ * performance_profiler_register() - Intern an operation name
+ * @profiler: Performance profiler handle
+ * @operation: Operation name
+ *
+ * Returns: Operation id for performance_profiler_probe(), the same for
+ *          the same name, or -1 when all operations are taken
+ */
+int performance_profiler_register(struct performance_profiler *profiler,
+                                  const char *operation);
+
+/**
+ * performance_profiler_probe() - Record the time since a tick count
+ * @profiler: Performance profiler handle
+ * @op: Operation id from performance_profiler_register()
+ * @start_ticks: performance_profiler_ticks() when the operation started
+ *
+ * Takes no lock and does not allocate once the calling thread has
+ * recorded its first sample. A sample that finds its thread's ring full
+ * is dropped and counted, see performance_profiler_get_dropped().
+ */
+void performance_profiler_probe(struct performance_profiler *profiler, int op,
+                                uint64_t start_ticks);
+
+/**
+ * performance_profiler_flush() - Merge the samples of every thread now
+ * @profiler: Performance profiler handle
+ */
+void performance_profiler_flush(struct performance_profiler *profiler);
+
+/**
+ * performance_profiler_get_dropped() - Count samples lost to full rings
+ * @profiler: Performance profiler handle
+ *
+ * Returns: Samples dropped since creation
+ */
+uint64_t performance_profiler_get_dropped(struct performance_profiler *profiler);
+
 /**
  * performance_profiler_start() - Start timing an operation
  * @profiler: Performance profiler handle
@@ -93,7 +173,8 @@ uint64_t performance_profiler_end(struct performance_profiler *profiler,
  * @duration_ns: Duration in nanoseconds
  * @context: Optional context string
  *
- * Use this for operations where you already have the duration
+ * Use this for operations where you already have the duration. Like
+ * performance_profiler_probe(), it records to the calling thread's ring.
  */
 void performance_profiler_record(struct performance_profiler *profiler,
                                  const char *operation,
@@ -124,6 +205,20 @@ size_t performance_profiler_detect_bottlenecks(struct performance_profiler *prof
                                                struct bottleneck_info *bottlenecks,
                                                size_t max_bottlenecks);
 
+/**
+ * performance_profiler_attach_samples() - Annotate operations with stack samples
+ * @profiler: Performance profiler handle
+ * @profile: Stack samples from stack_sampler_capture(), NULL to drop them
+ *
+ * Each operation gets the share of the samples spent in functions whose
+ * name contains the operation's, so operations should be named after the
+ * functions they time. performance_profiler_detect_bottlenecks() reports
+ * the share and counts an operation over its threshold as a bottleneck,
+ * until the next reset.
+ */
+void performance_profiler_attach_samples(struct performance_profiler *profiler,
+                                         const struct stack_profile *profile);
+
 /**
  * performance_profiler_export_json() - Export profiling data as JSON
  * @profiler: Performance profiler handle
@@ -182,7 +277,60 @@ void performance_profiler_list_operations(struct performance_profiler *profiler,
                                           void (*callback)(const struct profile_stats *, void *),
                                           void *user_data);
 
-/* Helper macros for easy profiling */
+/**
+ * performance_profiler_enable_tracing() - Aggregate the latency traces of events
+ * @profiler: Performance profiler handle
+ * @sample_rate: Keep the stages of 1 in @sample_rate events for
+ *               performance_profiler_export_chrome_trace(), 0 for outliers only
+ *
+ * Installs the profiler as the trace sink of event_trace.h, replacing any
+ * other. Every traced event adds its latency from receipt to each stage
+ * it reached to that stage's histogram. Sampled events, and events slower
+ * end to end than the slow threshold, are kept in a ring of the most
+ * recent ones.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int performance_profiler_enable_tracing(struct performance_profiler *profiler,
+                                        unsigned int sample_rate);
+
+/**
+ * performance_profiler_disable_tracing() - Stop tracing events
+ * @profiler: Performance profiler handle
+ *
+ * Only removes the sink if it is this profiler. Events already in flight
+ * may still report to it, so keep it until the pipeline has drained.
+ */
+void performance_profiler_disable_tracing(struct performance_profiler *profiler);
+
+/**
+ * performance_profiler_get_trace_stats() - Get per stage latency of traced events
+ * @profiler: Performance profiler handle
+ * @stats: Output for statistics
+ *
+ * Returns: true on success
+ */
+bool performance_profiler_get_trace_stats(struct performance_profiler *profiler,
+                                          struct trace_stats *stats);
+
+/**
+ * performance_profiler_export_chrome_trace() - Export kept events as a Chrome trace
+ * @profiler: Performance profiler handle
+ * @buffer: Output buffer
+ * @buffer_size: Size of output buffer
+ *
+ * Writes the sampled and outlier events in the Trace Event Format read by
+ * chrome://tracing and Perfetto: one row per event, one complete ("X")
+ * event per stage spanning from the stage before it. Events that do not
+ * fit in @buffer are left out.
+ *
+ * Returns: Number of bytes written or -1 on error
+ */
+ssize_t performance_profiler_export_chrome_trace(struct performance_profiler *profiler,
+                                                 char *buffer,
+                                                 size_t buffer_size);
+
+/* Helper macros for easy profiling, the PROBE ones for hot paths */
 #define PROFILE_START(profiler, op) \
 	performance_profiler_start(profiler, op, NULL)
 
@@ -192,4 +340,10 @@ void performance_profiler_list_operations(struct performance_profiler *profiler,
 #define PROFILE_END(profiler, id) \
 	performance_profiler_end(profiler, id)
 
+#define PROFILE_PROBE_START() \
+	performance_profiler_ticks()
+
+#define PROFILE_PROBE_END(profiler, op, start) \
+	performance_profiler_probe(profiler, op, start)
+
 #endif /* PERFORMANCE_PROFILER_H */
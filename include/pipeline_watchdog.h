@@ -0,0 +1,190 @@
+/* pipeline_watchdog.h - Stall detection of the pipeline threads
+ *
+ * Pipeline threads register a heartbeat slot and mark the stage they are
+ * in while working, each mark moving the slot's progress counter. The
+ * watchdog thread scans the slots and reports a thread that stayed in
+ * one stage without progress for longer than the stall threshold,
+ * together with its stack, captured by signalling the thread. A thread
+ * with no stage set is waiting for work and never stalls.
+ *
+ * A wedged thread cannot be stopped safely, so restarting a stage means
+ * what the thread's owner registered for it, such as starting another
+ * worker in its place. It runs once per stall, on the watchdog thread.
+ *
+ * Marking a stage costs two stores to a cache line only the thread
+ * writes; on threads without a slot it is a single branch.
+ */
+
+#ifndef PIPELINE_WATCHDOG_H
+#define PIPELINE_WATCHDOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+/* Threads watched at once, later registrations go unwatched */
+#define WATCHDOG_MAX_THREADS 64
+
+/* Frames captured of a stalled thread */
+#define WATCHDOG_MAX_FRAMES 32
+
+/**
+ * typedef nlmon_heartbeat_restart_fn - Restart of a stalled stage
+ * @ctx: Context given at registration
+ *
+ * Called on the watchdog thread with the watchdog's lock held; it must
+ * not wait for the stalled thread or register heartbeats itself.
+ *
+ * Returns: true if the stage was restarted
+ */
+typedef bool (*nlmon_heartbeat_restart_fn)(void *ctx);
+
+/* Heartbeat slot, the first line written only by its thread */
+struct nlmon_heartbeat {
+	_Atomic uint64_t progress;
+	_Atomic(const char *) stage;    /* Static string, NULL while waiting */
+} __attribute__((aligned(64)));
+
+/* Slot of the current thread, NULL if it did not register */
+extern __thread struct nlmon_heartbeat *nlmon_heartbeat_self;
+
+/**
+ * nlmon_heartbeat_register() - Watch the calling thread
+ * @name: Thread name, copied
+ * @restart: Restart of the thread's stage, or NULL
+ * @ctx: Passed to @restart
+ *
+ * Returns: Slot of the thread, NULL if the table is full
+ */
+struct nlmon_heartbeat *nlmon_heartbeat_register(const char *name,
+                                                 nlmon_heartbeat_restart_fn restart,
+                                                 void *ctx);
+
+/**
+ * nlmon_heartbeat_unregister() - Stop watching the calling thread
+ *
+ * Must be called before the thread exits. Does nothing if the thread
+ * did not register.
+ */
+void nlmon_heartbeat_unregister(void);
+
+/**
+ * nlmon_heartbeat_enter() - Mark the calling thread busy in a stage
+ * @stage: Static stage name
+ *
+ * Returns: Stage the thread was in, for nlmon_heartbeat_leave()
+ */
+static inline const char *nlmon_heartbeat_enter(const char *stage)
+{
+	struct nlmon_heartbeat *hb = nlmon_heartbeat_self;
+	const char *prev;
+	
+	if (!hb)
+		return NULL;
+	prev = atomic_load_explicit(&hb->stage, memory_order_relaxed);
+	atomic_store_explicit(&hb->stage, stage, memory_order_relaxed);
+	atomic_store_explicit(&hb->progress,
+	                      atomic_load_explicit(&hb->progress, memory_order_relaxed) + 1,
+	                      memory_order_release);
+	return prev;
+}
+
+/**
+ * nlmon_heartbeat_leave() - Return the calling thread to a stage
+ * @prev: What nlmon_heartbeat_enter() returned, NULL for waiting
+ */
+static inline void nlmon_heartbeat_leave(const char *prev)
+{
+	struct nlmon_heartbeat *hb = nlmon_heartbeat_self;
+	
+	if (!hb)
+		return;
+	atomic_store_explicit(&hb->stage, prev, memory_order_relaxed);
+	atomic_store_explicit(&hb->progress,
+	                      atomic_load_explicit(&hb->progress, memory_order_relaxed) + 1,
+	                      memory_order_release);
+}
+
+/**
+ * struct nlmon_stall - A stalled thread
+ * @name: Thread name
+ * @tid: Thread id
+ * @stage: Stage the thread is stuck in
+ * @stalled_ms: Time since its last progress
+ * @stack: Symbolized frames, one per line, or NULL if not captured
+ * @restarted: Whether its stage was restarted
+ */
+struct nlmon_stall {
+	const char *name;
+	pid_t tid;
+	const char *stage;
+	uint64_t stalled_ms;
+	const char *stack;
+	bool restarted;
+};
+
+/**
+ * typedef nlmon_stall_fn - Receiver of stalls
+ * @stall: Stall, valid until the call returns
+ * @ctx: Context from the configuration
+ *
+ * Called on the watchdog thread once per stall, not again until the
+ * thread made progress. The watchdog's lock is held, so it must not
+ * register heartbeats.
+ */
+typedef void (*nlmon_stall_fn)(const struct nlmon_stall *stall, void *ctx);
+
+/* Watchdog configuration, 0 takes the default */
+struct nlmon_watchdog_config {
+	unsigned int stall_ms;          /* Time without progress that is a stall, 5000 */
+	unsigned int interval_ms;       /* Time between scans, stall_ms / 4 */
+	bool restart;                   /* Restart stalled stages that can be */
+	nlmon_stall_fn on_stall;
+	void *ctx;
+};
+
+/* State of a watched thread */
+struct nlmon_heartbeat_stats {
+	const char *name;
+	pid_t tid;
+	const char *stage;              /* NULL while waiting */
+	uint64_t progress;
+	bool stalled;
+	uint64_t stalls;
+	uint64_t restarts;
+};
+
+/**
+ * nlmon_watchdog_start() - Start the watchdog thread
+ * @config: Configuration
+ *
+ * Returns: 0 on success, -1 on error or if it is running
+ */
+int nlmon_watchdog_start(const struct nlmon_watchdog_config *config);
+
+/**
+ * nlmon_watchdog_stop() - Stop the watchdog thread, if running
+ */
+void nlmon_watchdog_stop(void);
+
+/**
+ * nlmon_watchdog_check() - Scan the slots once on the calling thread
+ * @config: Configuration
+ *
+ * What the watchdog thread does each interval, for callers driving
+ * their own timer.
+ *
+ * Returns: Number of stalls found by this scan
+ */
+unsigned int nlmon_watchdog_check(const struct nlmon_watchdog_config *config);
+
+/**
+ * nlmon_watchdog_for_each() - Read the state of the watched threads
+ * @fn: Called per thread, the stats valid until it returns
+ * @ctx: Passed to @fn
+ */
+void nlmon_watchdog_for_each(void (*fn)(const struct nlmon_heartbeat_stats *stats, void *ctx),
+                             void *ctx);
+
+#endif /* PIPELINE_WATCHDOG_H */
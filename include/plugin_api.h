@@ -4,7 +4,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#define NLMON_PLUGIN_API_VERSION 1
+#define NLMON_PLUGIN_API_VERSION 5
 #define NLMON_PLUGIN_NAME_MAX 64
 #define NLMON_PLUGIN_VERSION_MAX 32
 #define NLMON_PLUGIN_DESC_MAX 256
@@ -28,6 +28,32 @@ typedef int (*nlmon_command_handler_t)(const char *args, char *response, size_t
 /* Plugin event filter function type */
 typedef int (*nlmon_event_filter_t)(struct nlmon_event *event);
 
+/* Argument a filter predicate takes */
+typedef enum {
+    NLMON_PREDICATE_ARG_NONE = 0,       /* name() */
+    NLMON_PREDICATE_ARG_STRING,         /* name("text") */
+    NLMON_PREDICATE_ARG_NUMBER          /* name(42) */
+} nlmon_predicate_arg_t;
+
+/* Filter predicate function type (API 5). Returns nonzero if the event
+ * matches; only the declared argument is set. Called from any thread
+ * evaluating filters, possibly several at once, so it must be thread
+ * safe and must not block. */
+typedef int (*nlmon_filter_predicate_t)(const struct nlmon_event *event, const char *string,
+                                        int64_t number, void *data);
+
+/* Events a plugin is interested in (API 4). Each list that is set
+ * narrows the events the plugin is called for, an unset one matches
+ * everything. The manager builds its dispatch table from these at load
+ * time, so a plugin is not even looked at for other events. Setting
+ * genl_families without protocols implies NETLINK_GENERIC. */
+typedef struct nlmon_plugin_interest {
+    const int *protocols;               /* NETLINK_* protocols, ended by -1 */
+    const uint16_t *msg_types;          /* nlmsg_type values, ended by 0 */
+    const char *const *genl_families;   /* Generic netlink families, ended by NULL */
+    const char *filter;                 /* Filter expression, see filter_parser.h */
+} nlmon_plugin_interest_t;
+
 /* Plugin context - provides API for plugins to interact with nlmon */
 typedef struct nlmon_plugin_context {
     /* Configuration access */
@@ -47,6 +73,15 @@ typedef struct nlmon_plugin_context {
     
     /* Store plugin-specific data */
     void *plugin_data;
+    
+    /* Register a filter predicate (API 5), callable in filter expressions
+     * as name(), name("text") or name(42). Only valid during init. Calls
+     * run after the plain comparisons of an AND/OR, the costlier the later,
+     * so cost_ns need only be a rough time per call. The predicate is
+     * unregistered before the plugin's cleanup. Returns 0 on success,
+     * negative errno on failure (-EEXIST if the name is taken). */
+    int (*register_predicate)(const char *name, nlmon_filter_predicate_t fn,
+                              nlmon_predicate_arg_t arg, uint32_t cost_ns, void *data);
 } nlmon_plugin_context_t;
 
 /* Plugin callbacks */
@@ -57,9 +92,17 @@ typedef struct nlmon_plugin_callbacks {
     /* Cleanup plugin - called once at unload time */
     void (*cleanup)(void);
     
-    /* Process event - called for each event if plugin subscribes to events */
+    /* Process event - called for each event if plugin subscribes to events.
+     * Returning 1 keeps the event from later plugins, for inline plugins. */
     int (*on_event)(struct nlmon_event *event);
     
+    /* Process a batch of events - preferred over on_event when set (API 2).
+     * Events that the plugin's event_filter rejects are not in the batch.
+     * The events are nlmon's own, not copies: they and the array are only
+     * valid until the call returns, and must not be modified. Copy what
+     * has to be kept. Returns 0 on success, negative on error. */
+    int (*on_events)(const struct nlmon_event *const *events, size_t count);
+    
     /* Handle custom command - called when plugin command is invoked */
     int (*on_command)(const char *cmd, const char *args, char *response, size_t resp_len);
     
@@ -81,12 +124,24 @@ typedef struct nlmon_plugin {
     /* Event filter - if set, only matching events are passed to on_event */
     nlmon_event_filter_t event_filter;
     
+    /* Interest - if set, only these events are routed to the plugin */
+    const nlmon_plugin_interest_t *interest;
+    
     /* Plugin flags */
     uint32_t flags;
 #define NLMON_PLUGIN_FLAG_NONE          0x00
-#define NLMON_PLUGIN_FLAG_PROCESS_ALL   0x01  /* Process all events */
-#define NLMON_PLUGIN_FLAG_ASYNC         0x02  /* Async event processing */
+#define NLMON_PLUGIN_FLAG_PROCESS_ALL   0x01  /* Process all events, ignoring filter and interest */
+#define NLMON_PLUGIN_FLAG_ASYNC         0x02  /* Async event processing (always, since API 3) */
 #define NLMON_PLUGIN_FLAG_CRITICAL      0x04  /* Critical plugin - failure stops nlmon */
+#define NLMON_PLUGIN_FLAG_INLINE        0x08  /* Run on the routing thread, not a worker */
+    
+    /* Event delivery (API 3). Each plugin runs on a worker thread of its
+     * own, fed by a bounded queue; events that do not fit are dropped.
+     * A plugin that keeps taking longer than its budget per event gets
+     * only a sample of the events, and is suspended for a while if that
+     * does not help. Zero selects the defaults. */
+    uint32_t latency_budget_us;         /* Budget per event (0 = 10000) */
+    uint32_t queue_size;                /* Events queued at most (0 = 1024) */
     
     /* Dependencies - NULL-terminated array of plugin names */
     const char **dependencies;
@@ -29,6 +29,21 @@ typedef struct plugin_info {
     int error_count;
     uint64_t events_processed;
     uint64_t events_filtered;
+    
+    /* Worker and latency budget, zero for inline plugins */
+    int isolated;                 /* Runs on a worker of its own */
+    size_t queue_depth;
+    size_t queue_capacity;
+    uint64_t events_dropped;      /* Queue full or plugin suspended */
+    uint64_t events_sampled;      /* Skipped while over budget */
+    uint64_t budget_violations;   /* Calls over the budget */
+    uint32_t latency_budget_us;
+    unsigned int sample_rate;     /* One in sample_rate events delivered */
+    int suspended;
+    double latency_mean_us;       /* Per event, measured on the worker */
+    double latency_p50_us;
+    double latency_p99_us;
+    double latency_max_us;
 } plugin_info_t;
 
 /* Create plugin manager */
@@ -61,9 +76,20 @@ int plugin_manager_disable(plugin_manager_t *mgr, const char *name);
 /* Reload a plugin */
 int plugin_manager_reload(plugin_manager_t *mgr, const char *name, nlmon_plugin_context_t *ctx);
 
+/* Replace a plugin with a fresh load of its file while events keep being
+ * routed. The new version is initialized next to the old one and gets its
+ * on_config_reload call before taking over; the old one delivers what it
+ * has queued before it is cleaned up and unloaded. */
+int plugin_manager_hot_reload(plugin_manager_t *mgr, const char *name, nlmon_plugin_context_t *ctx);
+
 /* Route event to all plugins */
 int plugin_manager_route_event(plugin_manager_t *mgr, struct nlmon_event *event);
 
+/* Route a batch of events to all plugins, with one on_events call per
+ * batched plugin. Returns the number of events delivered to plugins. */
+int plugin_manager_route_events(plugin_manager_t *mgr, struct nlmon_event **events,
+                                size_t count);
+
 /* Invoke plugin command */
 int plugin_manager_invoke_command(plugin_manager_t *mgr, const char *plugin_name,
                                   const char *cmd, const char *args,
@@ -72,6 +98,13 @@ int plugin_manager_invoke_command(plugin_manager_t *mgr, const char *plugin_name
 /* Get plugin info */
 int plugin_manager_get_info(plugin_manager_t *mgr, const char *name, plugin_info_t *info);
 
+/* Format a table of plugin statistics. Returns the length written. */
+size_t plugin_manager_format_stats(plugin_manager_t *mgr, char *buf, size_t len);
+
+/* Stats bus collector of the plugins part, ctx is the manager */
+struct nlmon_stats_snapshot;
+void plugin_manager_collect_stats(struct nlmon_stats_snapshot *snapshot, void *ctx);
+
 /* List all plugins */
 int plugin_manager_list(plugin_manager_t *mgr, plugin_info_t **list, size_t *count);
 
@@ -2,6 +2,28 @@
  *
  * Provides HTTP endpoint for Prometheus metrics scraping with
  * event counters, performance metrics, and system resource usage.
+ *
+ * Metrics are registered once in a hash table and updated through the
+ * handle registration returns, without taking a lock. Counters and
+ * histograms keep a slot per thread shard that is summed when scraped.
+ * The text sent to scrapers is cached and rebuilt at most once per
+ * cache interval, however many servers scrape.
+ *
+ * Histograms and summaries also record into a log-linear HDR histogram.
+ * Scrapers that accept the protobuf format get histograms as Prometheus
+ * native histograms, with the fixed buckets alongside. Summaries report
+ * quantiles from the HDR histogram in both formats.
+ *
+ * The HTTP server multiplexes non-blocking connections in one thread,
+ * keeps HTTP/1.1 connections alive and gzips the body for scrapers that
+ * send Accept-Encoding: gzip. A slow scraper does not delay the others.
+ *
+ * Cardinality limits keep a label such as the interface from growing a
+ * metric name without bound, see cardinality_governor.h. Series past a
+ * name's max_series collapse into its overflow series at registration,
+ * and each scrape leaves out stale series and folds all but the top_k
+ * busiest into the overflow series. The nlmon_metric_series gauges report
+ * per governed name the series kept, collapsed, folded and left out.
  */
 
 #ifndef PROMETHEUS_EXPORTER_H
@@ -10,17 +32,26 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "hdr_histogram.h"
+#include "cardinality_governor.h"
 
 /* Prometheus exporter handle (opaque) */
 struct prometheus_exporter;
 
+/* Metric handle (opaque), valid until the exporter is destroyed */
+struct prometheus_metric;
+
 /* Metric types */
 enum metric_type {
 	METRIC_TYPE_COUNTER,
 	METRIC_TYPE_GAUGE,
-	METRIC_TYPE_HISTOGRAM
+	METRIC_TYPE_HISTOGRAM,
+	METRIC_TYPE_SUMMARY         /* Quantiles 0.5, 0.9, 0.99 and 0.999 */
 };
 
+/* Default milliseconds a generated scrape response is reused for */
+#define PROMETHEUS_CACHE_INTERVAL_MS 1000
+
 /**
  * prometheus_exporter_create() - Create Prometheus exporter
  * @port: HTTP port to listen on
@@ -31,18 +62,131 @@ enum metric_type {
 struct prometheus_exporter *prometheus_exporter_create(uint16_t port,
                                                        const char *path);
 
+/**
+ * prometheus_exporter_set_affinity() - Pin the HTTP server thread
+ * @exporter: Prometheus exporter handle
+ * @cpus: CPU list such as "0-3" (NULL or "" for any CPU)
+ *
+ * Pinning is best effort. The thread is named "prom-http" either way.
+ *
+ * Returns: true on success, false if the list is invalid
+ */
+bool prometheus_exporter_set_affinity(struct prometheus_exporter *exporter,
+                                      const char *cpus);
+
 /**
  * prometheus_exporter_destroy() - Destroy Prometheus exporter
  * @exporter: Prometheus exporter handle
  */
 void prometheus_exporter_destroy(struct prometheus_exporter *exporter);
 
+/**
+ * prometheus_exporter_get_port() - Get the port the exporter listens on
+ * @exporter: Prometheus exporter handle
+ *
+ * Returns: Bound port, which the kernel chose if 0 was passed to create
+ */
+uint16_t prometheus_exporter_get_port(struct prometheus_exporter *exporter);
+
+/**
+ * prometheus_exporter_set_cache_interval() - Set how long responses are reused
+ * @exporter: Prometheus exporter handle
+ * @interval_ms: Milliseconds, 0 to generate a response for every scrape
+ *
+ * Scrapes within @interval_ms of the last generated response get the
+ * same text, so values can be up to @interval_ms old.
+ */
+void prometheus_exporter_set_cache_interval(struct prometheus_exporter *exporter,
+                                            unsigned int interval_ms);
+
+/**
+ * prometheus_exporter_set_cardinality() - Limit the series of a metric name
+ * @exporter: Prometheus exporter handle
+ * @name: Metric name, NULL for every name without limits of its own
+ * @limits: Limits, all 0 to lift them
+ *
+ * Folded series are added into the overflow series when scraped: counter
+ * and gauge values, histogram buckets and summary observations. Metrics
+ * listed through prometheus_exporter_list_metrics() are not governed.
+ *
+ * Returns: true on success, false on error
+ */
+bool prometheus_exporter_set_cardinality(struct prometheus_exporter *exporter,
+                                         const char *name,
+                                         const struct cardinality_limits *limits);
+
+/**
+ * prometheus_exporter_register() - Find or register a metric
+ * @exporter: Prometheus exporter handle
+ * @name: Metric name
+ * @labels: Label string (e.g., "type=\"link\"") or NULL
+ * @type: Metric type
+ *
+ * Finding an existing metric does not lock, registering a new one takes
+ * the registry lock once.
+ *
+ * Histograms and summaries use HDR_HISTOGRAM_DEFAULT_SCHEMA.
+ *
+ * A new label set past the name's max_series gets the handle of the
+ * name's overflow series instead.
+ *
+ * Returns: Metric handle, or NULL if the name or labels are too long,
+ * the metric exists with another type or the registry is full
+ */
+struct prometheus_metric *prometheus_exporter_register(struct prometheus_exporter *exporter,
+                                                       const char *name,
+                                                       const char *labels,
+                                                       enum metric_type type);
+
+/**
+ * prometheus_exporter_register_histogram() - Register a histogram or summary
+ * @exporter: Prometheus exporter handle
+ * @name: Metric name
+ * @labels: Label string or NULL
+ * @type: METRIC_TYPE_HISTOGRAM or METRIC_TYPE_SUMMARY
+ * @schema: HDR histogram schema 0-8, 2^@schema buckets per power of two
+ *
+ * @schema is the native histogram schema sent to Prometheus and sets the
+ * precision of summary quantiles. It is ignored if the metric exists.
+ *
+ * Returns: Metric handle or NULL on error, like prometheus_exporter_register()
+ */
+struct prometheus_metric *prometheus_exporter_register_histogram(struct prometheus_exporter *exporter,
+                                                                 const char *name,
+                                                                 const char *labels,
+                                                                 enum metric_type type,
+                                                                 int schema);
+
+/**
+ * prometheus_metric_inc() - Add to a counter
+ * @metric: Counter handle (NULL or another type is ignored)
+ * @value: Value to add
+ */
+void prometheus_metric_inc(struct prometheus_metric *metric, uint64_t value);
+
+/**
+ * prometheus_metric_set() - Set a gauge
+ * @metric: Gauge handle (NULL or another type is ignored)
+ * @value: Value to set
+ */
+void prometheus_metric_set(struct prometheus_metric *metric, double value);
+
+/**
+ * prometheus_metric_observe() - Add an observation to a histogram or summary
+ * @metric: Histogram or summary handle (NULL or another type is ignored)
+ * @value: Observed value
+ */
+void prometheus_metric_observe(struct prometheus_metric *metric, double value);
+
 /**
  * prometheus_exporter_inc_counter() - Increment a counter metric
  * @exporter: Prometheus exporter handle
  * @name: Metric name
  * @labels: Label string (e.g., "type=\"link\"") or NULL
  * @value: Value to add (typically 1)
+ *
+ * Looks the metric up on every call, callers that update a metric often
+ * should register it and keep the handle.
  */
 void prometheus_exporter_inc_counter(struct prometheus_exporter *exporter,
                                      const char *name,
@@ -73,6 +217,18 @@ void prometheus_exporter_observe_histogram(struct prometheus_exporter *exporter,
                                           const char *labels,
                                           double value);
 
+/**
+ * prometheus_exporter_observe_summary() - Add observation to summary
+ * @exporter: Prometheus exporter handle
+ * @name: Metric name
+ * @labels: Label string or NULL
+ * @value: Observed value
+ */
+void prometheus_exporter_observe_summary(struct prometheus_exporter *exporter,
+                                         const char *name,
+                                         const char *labels,
+                                         double value);
+
 /**
  * prometheus_exporter_update_system_metrics() - Update system resource metrics
  * @exporter: Prometheus exporter handle
@@ -81,6 +237,49 @@ void prometheus_exporter_observe_histogram(struct prometheus_exporter *exporter,
  */
 void prometheus_exporter_update_system_metrics(struct prometheus_exporter *exporter);
 
+struct nlmon_stats_snapshot;
+
+/**
+ * prometheus_exporter_publish_stats() - Set pipeline gauges from a snapshot
+ * @snapshot: Stats bus snapshot
+ * @ctx: Prometheus exporter handle
+ *
+ * A stats_bus_subscribe() callback. The totals of the snapshot are set
+ * as gauges, nlmon_pipeline_* for events and the thread pool and
+ * nlmon_{storage,export,netlink,plugin}_* for the rest.
+ */
+void prometheus_exporter_publish_stats(const struct nlmon_stats_snapshot *snapshot, void *ctx);
+
+/* Current value of a metric, see prometheus_exporter_list_metrics() */
+struct prometheus_sample {
+	const char *name;
+	const char *labels;
+	enum metric_type type;
+	double value;                   /* Counter or gauge */
+	uint64_t count;                 /* Histogram and summary observations */
+	double sum;
+	const double *bounds;           /* Histogram bucket upper bounds, the last +Inf */
+	const uint64_t *buckets;        /* Cumulative observations per bound */
+	unsigned int nbuckets;
+	const double *quantiles;        /* Summary quantiles and their values */
+	const double *quantile_values;
+	unsigned int nquantiles;
+};
+
+/**
+ * prometheus_exporter_list_metrics() - Read every metric
+ * @exporter: Prometheus exporter handle
+ * @fn: Called for each metric in registration order, the sample valid until it returns
+ * @ctx: Context for @fn
+ *
+ * Reads the values as a scrape does, without taking a lock, so other
+ * exporters can forward the metrics.
+ */
+void prometheus_exporter_list_metrics(struct prometheus_exporter *exporter,
+                                      void (*fn)(const struct prometheus_sample *sample,
+                                                 void *ctx),
+                                      void *ctx);
+
 /**
  * prometheus_exporter_get_stats() - Get exporter statistics
  * @exporter: Prometheus exporter handle
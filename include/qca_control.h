@@ -11,6 +11,8 @@
 #include <stdint.h>
 #include <stddef.h>
 
+struct nl_msg;
+
 /* QCA vendor ID */
 #define QCA_NL80211_VENDOR_ID  0x001374
 
@@ -26,9 +28,102 @@
  */
 typedef int (*qca_response_cb_t)(struct nl_msg *msg, void *arg);
 
+/* Commands a session keeps in flight, further ones wait for a slot */
+#define QCA_SESSION_MAX_PENDING  64
+
+/* Time a session waits for the driver before failing what is in flight */
+#define QCA_SESSION_TIMEOUT_MS   1000
+
+/**
+ * Control session
+ *
+ * Keeps one generic netlink socket with nl80211 resolved, so repeated
+ * commands skip the socket setup and family lookup. Commands are sent
+ * without waiting, each with its own sequence number, and their responses
+ * and acknowledgements are matched back to them by that number as they
+ * arrive, so commands to many interfaces take one round trip.
+ *
+ * A session is not thread safe.
+ */
+struct qca_session;
+
+/**
+ * Open a control session
+ * 
+ * @return: Session, NULL if nl80211 is not available
+ */
+struct qca_session *qca_session_open(void);
+
+/**
+ * Close a control session, commands still in flight are dropped
+ * 
+ * @param session: Session (can be NULL)
+ */
+void qca_session_close(struct qca_session *session);
+
+/**
+ * Send a vendor command without waiting for it
+ * 
+ * Waits for earlier commands first when QCA_SESSION_MAX_PENDING are in
+ * flight. The callback runs from qca_session_wait() for each response.
+ * 
+ * @param session: Session
+ * @param ifname: Interface name
+ * @param subcmd: Vendor subcommand ID
+ * @param data: Command data (can be NULL)
+ * @param data_len: Length of command data
+ * @param response_cb: Callback for responses (can be NULL)
+ * @param user_data: User data passed to callback
+ * @param error: Set to 0 or a negative errno once the command completes,
+ *               -EINPROGRESS until then (can be NULL)
+ * @return: 0 on success, -1 on error
+ */
+int qca_session_submit(struct qca_session *session,
+                       const char *ifname,
+                       uint32_t subcmd,
+                       const void *data,
+                       size_t data_len,
+                       qca_response_cb_t response_cb,
+                       void *user_data,
+                       int *error);
+
+/**
+ * Wait for every command in flight
+ * 
+ * Commands the driver does not answer within QCA_SESSION_TIMEOUT_MS
+ * fail with -ETIMEDOUT.
+ * 
+ * @param session: Session
+ * @return: Number of commands that failed, -1 on a socket error
+ */
+int qca_session_wait(struct qca_session *session);
+
+/**
+ * Get link layer statistics of several interfaces in one round trip
+ * 
+ * Responses carry NL80211_ATTR_IFINDEX to tell them apart.
+ * 
+ * @param session: Session
+ * @param ifnames: Interface names
+ * @param count: Number of interfaces
+ * @param callback: Callback for responses (can be NULL)
+ * @param user_data: User data passed to callback
+ * @param errors: Per interface result, 0 or a negative errno (can be NULL)
+ * @return: Number of interfaces that failed, -1 on a socket error
+ */
+int qca_session_get_link_stats(struct qca_session *session,
+                               const char *const *ifnames,
+                               size_t count,
+                               qca_response_cb_t callback,
+                               void *user_data,
+                               int *errors);
+
 /**
  * Send QCA vendor command
  * 
+ * Opens a session for this one command, see qca_session_submit(). Only
+ * waits for the driver when a callback is given.
+ * 
  * @param ifname: Interface name (e.g., "wlan0")
  * @param subcmd: Vendor subcommand ID
  * @param data: Command data (can be NULL)
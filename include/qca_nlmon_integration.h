@@ -7,11 +7,135 @@
 #ifndef QCA_NLMON_INTEGRATION_H
 #define QCA_NLMON_INTEGRATION_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 /* Forward declaration */
 struct nlmon_event;
 
+/* Event type of the link stats deltas published by a stats poller */
+#define QCA_NLMON_EVENT_LINK_STATS 0x1001
+
+/* Interfaces a poller fetches, and counters it keeps per interface */
+#define QCA_STATS_MAX_INTERFACES 8
+#define QCA_STATS_MAX_COUNTERS   512
+
+/* Nesting levels of the vendor data walked for counters */
+#define QCA_STATS_MAX_DEPTH      3
+
+/**
+ * Link stats counter that changed since the previous sample
+ * 
+ * The driver answers with several replies per interface (radio, iface,
+ * peers), each nesting its counters in the vendor data. A counter is known
+ * by its reply within the sample in bits 32-47 of the key and by the path
+ * of attribute types leading to it in the low bits, 10 bits per level from
+ * the outermost, see qca_stats_key_format().
+ */
+struct qca_stats_counter {
+	uint64_t key;
+	uint64_t value;
+	int64_t delta;               /* Since the previous sample, a wrapped counter counts on */
+};
+
+/**
+ * Called with the changed counters of one reply
+ * 
+ * The event has type QCA_NLMON_EVENT_LINK_STATS, the interface name and
+ * data pointing to an array of struct qca_stats_counter, all valid for
+ * the call only.
+ */
+typedef void (*qca_stats_sink_t)(struct nlmon_event *event, void *user_data);
+
+/* Stats poller configuration */
+struct qca_stats_poller_config {
+	const char *const *ifnames;  /* Interfaces to poll */
+	size_t count;                /* Up to QCA_STATS_MAX_INTERFACES */
+	unsigned int interval_ms;    /* Mean time between polls */
+	unsigned int jitter_pct;     /* Spread of the interval, 0 to 50 percent */
+	qca_stats_sink_t sink;       /* Receives the changed counters */
+	void *user_data;             /* Passed to sink */
+};
+
+/**
+ * Stats poller
+ * 
+ * Fetches link layer statistics of its interfaces over one persistent
+ * control session, all interfaces in one round trip, and hands on only
+ * the counters that changed since the previous sample. The first sample
+ * of an interface sets its baseline and reports nothing. Jittered poll
+ * intervals keep pollers of many hosts or radios from firing together.
+ * 
+ * A poller is not thread safe.
+ */
+struct qca_stats_poller;
+
+/**
+ * Create a stats poller, its session is opened by the first poll
+ * 
+ * @param config: Poller configuration
+ * @return: Poller, NULL on invalid configuration or allocation failure
+ */
+struct qca_stats_poller *qca_stats_poller_create(const struct qca_stats_poller_config *config);
+
+/**
+ * Fetch and report the link stats of every interface
+ * 
+ * A session lost to a socket error is opened again by the next poll.
+ * 
+ * @param poller: Poller
+ * @return: Number of interfaces that failed, -1 if nl80211 is not available
+ */
+int qca_stats_poller_poll(struct qca_stats_poller *poller);
+
+/**
+ * Compare one reply of a sample with the previous sample
+ * 
+ * Called by qca_stats_poller_poll() for each reply, exposed to feed
+ * samples captured elsewhere.
+ * 
+ * @param poller: Poller
+ * @param ifname: Interface of the reply, one of the poller's
+ * @param reply: Number of the reply within the sample, from 0
+ * @param data: Vendor data of the reply (NL80211_ATTR_VENDOR_DATA payload)
+ * @param len: Length of data
+ * @return: Number of changed counters reported, -1 for an unknown interface
+ */
+int qca_stats_poller_update(struct qca_stats_poller *poller, const char *ifname,
+                            unsigned int reply, const void *data, size_t len);
+
+/**
+ * Forget the samples of every interface, the next poll sets new baselines
+ * 
+ * @param poller: Poller
+ */
+void qca_stats_poller_reset(struct qca_stats_poller *poller);
+
+/**
+ * Time until the next poll, the interval moved by up to its jitter
+ * 
+ * @param poller: Poller
+ * @return: Milliseconds
+ */
+unsigned int qca_stats_poller_next_ms(struct qca_stats_poller *poller);
+
+/**
+ * Destroy a stats poller and close its session
+ * 
+ * @param poller: Poller (can be NULL)
+ */
+void qca_stats_poller_destroy(struct qca_stats_poller *poller);
+
+/**
+ * Format a counter key as "reply:type.type.type"
+ * 
+ * @param key: Counter key
+ * @param buf: Output buffer
+ * @param len: Size of buf
+ * @return: Length written, as snprintf()
+ */
+int qca_stats_key_format(uint64_t key, char *buf, size_t len);
+
 /**
  * Initialize QCA-nlmon integration
  * 
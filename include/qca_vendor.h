@@ -22753,6 +22753,29 @@ extern "C" {
  */
 const char *qca_vendor_subcmd_to_string(unsigned int subcmd);
 
+/**
+ * Convert QCA vendor subcommand name to its ID
+ * @param name Name, with or without the QCA_NL80211_VENDOR_SUBCMD_ prefix
+ * @param subcmd Output for the subcommand ID
+ * @return 0 on success, -1 if the name is unknown
+ */
+int qca_vendor_subcmd_from_string(const char *name, unsigned int *subcmd);
+
+/**
+ * Convert QCA vendor attribute (enum qca_wlan_vendor_attr) to string
+ * @param attr Attribute ID
+ * @return String representation of attribute, or NULL if unknown
+ */
+const char *qca_vendor_attr_to_string(unsigned int attr);
+
+/**
+ * Convert QCA vendor attribute name to its ID
+ * @param name Name, with or without the QCA_WLAN_VENDOR_ATTR_ prefix
+ * @param attr Output for the attribute ID
+ * @return 0 on success, -1 if the name is unknown
+ */
+int qca_vendor_attr_from_string(const char *name, unsigned int *attr);
+
 #ifdef __cplusplus
 }
 #endif
@@ -266,6 +266,10 @@ struct wmi_log_entry {
 /* Helper function to get WMI command name */
 const char *wmi_cmd_to_string(unsigned int cmd_id);
 
+/* Convert WMI command name ("WMI_START_SCAN_CMDID" or "START_SCAN") of
+ * len bytes to its ID. Returns 0 on success, -1 if the name is unknown. */
+int wmi_cmd_from_string(const char *name, size_t len, unsigned int *cmd_id);
+
 /* Convert stats type ID to string */
 const char *wmi_stats_to_string(unsigned int stats_id);
 
@@ -1,7 +1,13 @@
 /* rate_limiter.h - Token bucket rate limiter for event processing
  *
  * Implements token bucket algorithm for rate limiting with per-event-type
- * support and statistics tracking.
+ * support and statistics tracking. Checks never take a lock, only
+ * configuration changes do.
+ *
+ * A rate limiter map applies up to three levels to each event: a limit
+ * per key such as the interface, then the limit of its event type, then
+ * a global limit over all events. Keys are tracked in a bounded table
+ * that forgets the least recently seen ones.
  */
 
 #ifndef RATE_LIMITER_H
@@ -90,9 +96,40 @@ void rate_limiter_stats(struct rate_limiter *rl,
 /* Per-event-type rate limiter */
 struct rate_limiter_map;
 
+/* What a per-key limit is keyed on */
+enum rate_limiter_key_class {
+	RATE_LIMITER_KEY_INTERFACE = 0, /* Interface name */
+	RATE_LIMITER_KEY_GENL_FAMILY,   /* Generic netlink family name */
+	RATE_LIMITER_KEY_CLASSES,
+};
+
+/* Longest key compared, longer names are cut */
+#define RATE_LIMITER_KEY_MAX 31
+
+/* Most keys one check applies */
+#define RATE_LIMITER_MAX_KEYS 8
+
+/* Keys tracked by default, see rate_limiter_map_set_key_capacity() */
+#define RATE_LIMITER_KEY_ENTRIES 1024
+
+/* Key of one event */
+struct rate_limiter_key {
+	enum rate_limiter_key_class key_class;
+	const char *name;               /* Need not be NUL terminated */
+	size_t len;
+};
+
+/* Statistics of one tracked key */
+struct rate_limiter_key_stats {
+	enum rate_limiter_key_class key_class;
+	char name[RATE_LIMITER_KEY_MAX + 1];
+	unsigned long allowed;
+	unsigned long denied;
+};
+
 /**
  * rate_limiter_map_create() - Create per-event-type rate limiter
- * @default_rate: Default rate for unspecified event types
+ * @default_rate: Default rate for unspecified event types, 0 for none
  * @default_burst: Default burst for unspecified event types
  *
  * Returns: Pointer to rate limiter map or NULL on error
@@ -118,6 +155,45 @@ void rate_limiter_map_destroy(struct rate_limiter_map *map);
 bool rate_limiter_map_set(struct rate_limiter_map *map, uint32_t event_type,
                           double rate, size_t burst);
 
+/**
+ * rate_limiter_map_set_global() - Set the limit over all events
+ * @map: Rate limiter map
+ * @rate: Rate limit (events per second)
+ * @burst: Burst size
+ *
+ * Returns: true on success, false on error
+ */
+bool rate_limiter_map_set_global(struct rate_limiter_map *map, double rate, size_t burst);
+
+/**
+ * rate_limiter_map_set_key_capacity() - Set how many keys are tracked
+ * @map: Rate limiter map
+ * @entries: Keys tracked at once, rounded up to a power of two
+ *
+ * Only possible before the first rate_limiter_map_set_key_limit(), which
+ * otherwise creates a table of RATE_LIMITER_KEY_ENTRIES keys.
+ *
+ * Returns: true on success, false if the table exists or on error
+ */
+bool rate_limiter_map_set_key_capacity(struct rate_limiter_map *map, size_t entries);
+
+/**
+ * rate_limiter_map_set_key_limit() - Set the limit of every key of a class
+ * @map: Rate limiter map
+ * @key_class: Class of keys
+ * @rate: Rate limit (events per second), 0 to remove the limit
+ * @burst: Events allowed within any burst / @rate seconds
+ *
+ * Each key is counted over a sliding window of burst / rate seconds. Keys
+ * are tracked in sets of a few entries each; a new key replaces the least
+ * recently seen one of its set, forgetting its count.
+ *
+ * Returns: true on success, false on error
+ */
+bool rate_limiter_map_set_key_limit(struct rate_limiter_map *map,
+                                    enum rate_limiter_key_class key_class,
+                                    double rate, size_t burst);
+
 /**
  * rate_limiter_map_allow() - Check if event type is allowed
  * @map: Rate limiter map
@@ -127,6 +203,23 @@ bool rate_limiter_map_set(struct rate_limiter_map *map, uint32_t event_type,
  */
 bool rate_limiter_map_allow(struct rate_limiter_map *map, uint32_t event_type);
 
+/**
+ * rate_limiter_map_allow_keys() - Check an event against every level
+ * @map: Rate limiter map
+ * @event_type: Event type identifier
+ * @keys: Keys of the event, may be NULL if @count is 0
+ * @count: Number of keys, at most RATE_LIMITER_MAX_KEYS are applied
+ *
+ * The keys are checked first, then the event type, then the global
+ * limit. An event denied at one level is given back to the levels that
+ * had already counted it, so a busy key does not use up the budget of
+ * its event type.
+ *
+ * Returns: true if event is allowed, false if rate limited
+ */
+bool rate_limiter_map_allow_keys(struct rate_limiter_map *map, uint32_t event_type,
+                                 const struct rate_limiter_key *keys, size_t count);
+
 /**
  * rate_limiter_map_reset() - Reset all rate limiters
  * @map: Rate limiter map
@@ -146,4 +239,18 @@ void rate_limiter_map_stats(struct rate_limiter_map *map, uint32_t event_type,
                             unsigned long *denied,
                             double *current_rate);
 
+/**
+ * rate_limiter_map_top_keys() - Get the keys denied most often
+ * @map: Rate limiter map
+ * @stats: Output array, may be NULL if @max is 0
+ * @max: Number of entries in @stats
+ *
+ * Keys are ordered by denied events, then allowed events. Only keys still
+ * tracked are reported.
+ *
+ * Returns: Number of entries filled
+ */
+size_t rate_limiter_map_top_keys(struct rate_limiter_map *map,
+                                 struct rate_limiter_key_stats *stats, size_t max);
+
 #endif /* RATE_LIMITER_H */
@@ -12,6 +12,7 @@
 #include <stdbool.h>
 #include <time.h>
 #include <sys/types.h>
+#include "cardinality_governor.h"
 
 /* Metric types */
 enum metric_type {
@@ -33,13 +34,16 @@ union metric_value {
 	} histogram;
 };
 
+/* Upper bounds of the histogram buckets, the last is +Inf */
+extern const double metric_histogram_bounds[10];
+
 /* Metric structure */
 struct metric {
 	char name[128];
 	char labels[256];
 	enum metric_type type;
 	union metric_value value;
-	time_t last_updated;
+	time_t last_updated;          /* When a read last found the value changed */
 	bool in_use;
 };
 
@@ -86,6 +90,79 @@ struct resource_tracker *resource_tracker_create(size_t max_metrics);
  */
 void resource_tracker_destroy(struct resource_tracker *tracker);
 
+/**
+ * resource_tracker_register() - Register a metric for updates by handle
+ * @tracker: Resource tracker handle
+ * @name: Metric name
+ * @labels: Optional labels (e.g., "type=link")
+ * @type: Metric type
+ *
+ * Registering a metric that exists returns its handle. Handles stay valid
+ * for the life of the tracker and update the metric without a lock or a
+ * lookup, which makes them the way to update metrics on hot paths.
+ *
+ * A new label set past the name's max_series, see
+ * resource_tracker_set_cardinality(), gets the overflow series' handle.
+ *
+ * Returns: Metric handle, or -1 if the tracker is full or the metric
+ * exists with another type
+ */
+int resource_tracker_register(struct resource_tracker *tracker,
+                              const char *name,
+                              const char *labels,
+                              enum metric_type type);
+
+/**
+ * resource_tracker_set_cardinality() - Limit the series of a metric name
+ * @tracker: Resource tracker handle
+ * @name: Metric name, NULL for every name without limits of its own
+ * @limits: Limits, all 0 to lift them
+ *
+ * Registering a label set past max_series returns the handle of the
+ * name's overflow series. Listing and exporting leave out series
+ * unchanged for stale_ms and add all but the top_k busiest since the last
+ * read into the overflow series. The nlmon_metric_series gauges report
+ * per governed name the series kept, collapsed, folded and left out.
+ *
+ * Returns: true on success, false on error
+ */
+bool resource_tracker_set_cardinality(struct resource_tracker *tracker,
+                                      const char *name,
+                                      const struct cardinality_limits *limits);
+
+/**
+ * resource_tracker_counter_add() - Add to a counter by handle
+ * @tracker: Resource tracker handle
+ * @metric: Handle of a counter
+ * @value: Value to add
+ *
+ * Each thread adds to a shard of its own, the shards are summed when the
+ * counter is read.
+ *
+ * Returns: true on success, false if @metric is not a counter
+ */
+bool resource_tracker_counter_add(struct resource_tracker *tracker, int metric, uint64_t value);
+
+/**
+ * resource_tracker_gauge_update() - Set a gauge by handle
+ * @tracker: Resource tracker handle
+ * @metric: Handle of a gauge
+ * @value: Value to set
+ *
+ * Returns: true on success, false if @metric is not a gauge
+ */
+bool resource_tracker_gauge_update(struct resource_tracker *tracker, int metric, double value);
+
+/**
+ * resource_tracker_histogram_record() - Add an observation by handle
+ * @tracker: Resource tracker handle
+ * @metric: Handle of a histogram
+ * @value: Observed value
+ *
+ * Returns: true on success, false if @metric is not a histogram
+ */
+bool resource_tracker_histogram_record(struct resource_tracker *tracker, int metric, double value);
+
 /**
  * resource_tracker_counter_inc() - Increment counter metric
  * @tracker: Resource tracker handle
@@ -93,6 +170,9 @@ void resource_tracker_destroy(struct resource_tracker *tracker);
  * @labels: Optional labels (e.g., "type=link")
  * @value: Value to add (typically 1)
  *
+ * Looks the metric up by name on every call, see
+ * resource_tracker_register() for updates on hot paths.
+ *
  * Returns: true on success
  */
 bool resource_tracker_counter_inc(struct resource_tracker *tracker,
@@ -128,6 +208,38 @@ bool resource_tracker_histogram_observe(struct resource_tracker *tracker,
                                         const char *labels,
                                         double value);
 
+/**
+ * resource_tracker_histogram_quantile() - Estimate a quantile of a histogram
+ * @tracker: Resource tracker handle
+ * @name: Metric name
+ * @labels: Optional labels
+ * @quantile: Quantile from 0 to 1, e.g. 0.999
+ * @value: Output for the estimate, NaN if nothing was observed
+ *
+ * Histograms keep log-linear buckets besides the fixed ones, so the
+ * estimate is within the precision set by
+ * resource_tracker_set_histogram_schema() whatever the distribution.
+ *
+ * Returns: true if the histogram was found
+ */
+bool resource_tracker_histogram_quantile(struct resource_tracker *tracker,
+                                         const char *name,
+                                         const char *labels,
+                                         double quantile,
+                                         double *value);
+
+/**
+ * resource_tracker_set_histogram_schema() - Set histogram precision
+ * @tracker: Resource tracker handle
+ * @schema: HDR histogram schema 0-8, 2^@schema buckets per power of two
+ *
+ * Applies to histograms created afterwards. The default is
+ * HDR_HISTOGRAM_DEFAULT_SCHEMA, about 4% relative error.
+ *
+ * Returns: true on success, false if @schema is out of range
+ */
+bool resource_tracker_set_histogram_schema(struct resource_tracker *tracker, int schema);
+
 /**
  * resource_tracker_get_metric() - Get metric value
  * @tracker: Resource tracker handle
@@ -2,6 +2,11 @@
  *
  * Provides time-based and size-based retention policy enforcement
  * for event storage with configurable policies and automatic cleanup.
+ *
+ * Stored events are accounted per time slice, so size-based retention
+ * knows how many events and bytes each slice holds and drops exactly the
+ * oldest slices that bring the database under its limits, without
+ * counting rows.
  */
 
 #ifndef RETENTION_POLICY_H
@@ -15,6 +20,7 @@
 /* Forward declarations */
 struct storage_db;
 struct storage_buffer;
+struct storage_log;
 
 /* Retention policy structure (opaque) */
 struct retention_policy;
@@ -35,6 +41,17 @@ struct retention_policy_config {
 	/* Policy behavior */
 	bool delete_oldest_first;       /* Delete oldest when limit reached */
 	size_t batch_delete_size;       /* Number of events to delete per batch */
+	
+	/* Accounting of stored events, fixed at creation */
+	time_t bucket_seconds;          /* Time slice per bucket (0=max age / 64, else 1 hour) */
+	
+	/* Cleanup thread placement */
+	const char *cpus;               /* CPU list of the cleanup thread (NULL=any) */
+	
+	/* Background database maintenance by the cleanup thread */
+	uint32_t maintenance_interval_ms; /* Vacuum and WAL checkpoint interval (0=none) */
+	uint32_t vacuum_step_pages;     /* Pages per incremental vacuum step (0=default) */
+	size_t busy_queue_depth;        /* Writer queue depth deferring work (0=never defer) */
 };
 
 /* Retention statistics */
@@ -45,6 +62,22 @@ struct retention_stats {
 	uint64_t last_deleted_count;
 	uint64_t current_event_count;
 	uint64_t current_db_size_bytes;
+	uint64_t cleanups_deferred;     /* Cleanups put off by a busy writer */
+	uint64_t admit_from;            /* Oldest timestamp check_event() admits */
+	uint64_t rejected;              /* Events check_event() turned away */
+	
+	/* Background maintenance */
+	uint64_t maintenance_deferred;  /* Maintenance runs put off by a busy writer */
+	uint64_t vacuum_steps;
+	uint64_t vacuum_pages;          /* Pages returned to the file system */
+	uint64_t vacuum_last_us;
+	uint64_t vacuum_max_us;
+	uint64_t vacuum_total_us;
+	uint64_t checkpoints;           /* WAL checkpoints with frames to write */
+	uint64_t checkpoint_frames;     /* WAL frames written back */
+	uint64_t checkpoint_last_us;
+	uint64_t checkpoint_max_us;
+	uint64_t checkpoint_total_us;
 };
 
 /**
@@ -60,6 +93,15 @@ struct retention_policy *retention_policy_create(
 	struct storage_db *db,
 	struct storage_buffer *buffer);
 
+/**
+ * retention_policy_set_log() - Apply time-based retention to a segment log
+ * @policy: Retention policy handle
+ * @log: Segment log handle (NULL to detach)
+ *
+ * The log loses whole segments older than the maximum age.
+ */
+void retention_policy_set_log(struct retention_policy *policy, struct storage_log *log);
+
 /**
  * retention_policy_destroy() - Destroy retention policy
  * @policy: Retention policy handle
@@ -78,8 +120,11 @@ int retention_policy_enforce(struct retention_policy *policy);
  * retention_policy_start() - Start automatic policy enforcement
  * @policy: Retention policy handle
  *
+ * With maintenance_interval_ms set, the thread also vacuums the database
+ * in steps and checkpoints its WAL in between cleanups.
+ *
  * Returns: true on success, false on error
- * Note: Starts background thread for periodic cleanup
+ * Note: Starts background thread for periodic cleanup, named "retention"
  */
 bool retention_policy_start(struct retention_policy *policy);
 
@@ -94,11 +139,27 @@ void retention_policy_stop(struct retention_policy *policy);
  * @policy: Retention policy handle
  * @timestamp: Event timestamp
  *
+ * Compares against a watermark cached per second, raised past the
+ * slices size-based retention dropped, so the check takes no lock.
+ *
  * Returns: true if event should be retained, false if it should be deleted
  */
 bool retention_policy_check_event(struct retention_policy *policy,
                                   uint64_t timestamp);
 
+/**
+ * retention_policy_account() - Account an event stored in the database
+ * @policy: Retention policy handle
+ * @timestamp: Event timestamp
+ * @bytes: Approximate bytes the event takes in the database
+ *
+ * Adds the event to the bucket of its time slice, which size-based
+ * retention picks the slices to drop by. Lock-free unless the event
+ * opens a new slice.
+ */
+void retention_policy_account(struct retention_policy *policy,
+                              uint64_t timestamp, size_t bytes);
+
 /**
  * retention_policy_get_stats() - Get retention statistics
  * @policy: Retention policy handle
@@ -114,6 +175,8 @@ bool retention_policy_get_stats(struct retention_policy *policy,
  * @policy: Retention policy handle
  * @config: New configuration
  *
+ * bucket_seconds keeps its value of creation.
+ *
  * Returns: true on success, false on error
  */
 bool retention_policy_update_config(struct retention_policy *policy,
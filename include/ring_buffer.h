@@ -2,6 +2,8 @@
  *
  * This implements a single-producer, single-consumer (SPSC) lock-free
  * ring buffer using atomic operations for high-performance event queuing.
+ * A bounded multi-producer, multi-consumer (MPMC) variant with per-slot
+ * sequence numbers shares the same API.
  */
 
 #ifndef RING_BUFFER_H
@@ -12,13 +14,26 @@
 #include <stdbool.h>
 #include <stdatomic.h>
 
+/* MPMC slot, sequence tells producers and consumers whose turn it is */
+struct ring_buffer_slot {
+	atomic_size_t sequence;
+	void *item;
+};
+
 /* Ring buffer structure */
 struct ring_buffer {
-	void **data;                    /* Array of pointers to events */
+	void **data;                    /* SPSC: array of pointers to events */
+	struct ring_buffer_slot *slots; /* MPMC: slots with sequence numbers */
 	size_t capacity;                /* Buffer capacity (power of 2) */
 	size_t mask;                    /* Capacity - 1 (for fast modulo) */
-	atomic_size_t head;             /* Write position */
-	atomic_size_t tail;             /* Read position */
+	bool mpmc;                      /* Created by ring_buffer_create_mpmc() */
+	
+	/* Indices and statistics on separate cache lines */
+	char pad_head[64];
+	atomic_size_t head;             /* Write position (MPMC: unwrapped) */
+	char pad_tail[64];
+	atomic_size_t tail;             /* Read position (MPMC: unwrapped) */
+	char pad_stats[64];
 	
 	/* Statistics */
 	atomic_ulong enqueue_count;     /* Total enqueued */
@@ -35,6 +50,17 @@ struct ring_buffer {
  */
 struct ring_buffer *ring_buffer_create(size_t capacity);
 
+/**
+ * ring_buffer_create_mpmc() - Create a multi-producer, multi-consumer ring buffer
+ * @capacity: Minimum number of items (rounded up to a power of 2)
+ *
+ * All ring_buffer_* operations may be called concurrently from any
+ * number of threads. Unlike the SPSC buffer every slot is usable.
+ *
+ * Returns: Pointer to ring buffer or NULL on error
+ */
+struct ring_buffer *ring_buffer_create_mpmc(size_t capacity);
+
 /**
  * ring_buffer_destroy() - Destroy ring buffer
  * @rb: Ring buffer to destroy
@@ -60,6 +86,29 @@ bool ring_buffer_enqueue(struct ring_buffer *rb, void *item);
  */
 void *ring_buffer_dequeue(struct ring_buffer *rb);
 
+/**
+ * ring_buffer_enqueue_bulk() - Add up to @count items to ring buffer
+ * @rb: Ring buffer
+ * @items: Items to add, in order (must not be NULL)
+ * @count: Number of items
+ *
+ * Items that do not fit are not added and count as overflows. On an
+ * MPMC buffer the added items occupy consecutive positions.
+ *
+ * Returns: Number of items added, from the start of @items
+ */
+size_t ring_buffer_enqueue_bulk(struct ring_buffer *rb, void *const *items, size_t count);
+
+/**
+ * ring_buffer_dequeue_bulk() - Remove up to @max items from ring buffer
+ * @rb: Ring buffer
+ * @items: Output array for items, oldest first
+ * @max: Capacity of @items
+ *
+ * Returns: Number of items removed, 0 if buffer is empty
+ */
+size_t ring_buffer_dequeue_bulk(struct ring_buffer *rb, void **items, size_t max);
+
 /**
  * ring_buffer_is_empty() - Check if buffer is empty
  * @rb: Ring buffer
@@ -13,6 +13,9 @@
 
 /* Forward declarations */
 struct nlmon_event;
+struct fib_mirror;
+struct neigh_mirror;
+struct ct_mirror;
 
 /* Security event severity levels */
 enum security_severity {
@@ -30,7 +33,8 @@ enum security_event_type {
 	SECURITY_ROUTE_HIJACK,
 	SECURITY_SUSPICIOUS_INTERFACE,
 	SECURITY_NEIGHBOR_FLOOD,
-	SECURITY_INTERFACE_STORM
+	SECURITY_INTERFACE_STORM,
+	SECURITY_NEIGHBOR_SPOOF
 };
 
 /* Security event structure */
@@ -52,12 +56,14 @@ struct security_detector_config {
 	bool enable_arp_flood_detection;
 	double arp_rate_threshold;        /* ARP entries per second */
 	size_t arp_time_window;           /* Time window in seconds */
+	size_t arp_distinct_threshold;    /* Distinct neighbors per interface in the window, 0 off */
 	
 	/* Promiscuous mode detection */
 	bool enable_promisc_detection;
 	
 	/* Route hijack detection */
 	bool enable_route_hijack_detection;
+	size_t route_mirror_limit;        /* Routes mirrored, 0 for no limit */
 	
 	/* Suspicious interface detection */
 	bool enable_suspicious_interface_detection;
@@ -71,6 +77,13 @@ struct security_detector_config {
 	bool enable_interface_storm_detection;
 	size_t interface_storm_threshold;  /* Events per second */
 	size_t interface_storm_window;     /* Time window in seconds */
+	
+	/* Neighbor spoof detection */
+	bool enable_neighbor_spoof_detection;
+	size_t neighbor_mirror_limit;     /* Neighbors mirrored, 0 for the default */
+	
+	/* Conntrack mirror */
+	size_t conntrack_mirror_limit;    /* Flows mirrored, 0 for the default */
 };
 
 /* Security detector structure (opaque) */
@@ -114,11 +127,49 @@ void security_detector_unregister_callback(struct security_detector *sd, int cal
  * @sd: Security detector
  * @event: Network event to analyze
  *
+ * Runs the enabled detectors registered for the message type of @event.
+ * Safe to call from several threads, events of different interfaces only
+ * share the flood rate and mirror locks.
+ *
  * Returns: true if security event was detected
  */
 bool security_detector_process_event(struct security_detector *sd,
                                      struct nlmon_event *event);
 
+/**
+ * security_detector_routes() - Get the mirror of the routing tables
+ * @sd: Security detector
+ *
+ * Kept from the route events the detector processes, whether or not
+ * route hijack detection is enabled, to answer route queries without a
+ * dump from the kernel. Lives as long as the detector.
+ *
+ * Returns: Mirror or NULL
+ */
+struct fib_mirror *security_detector_routes(struct security_detector *sd);
+
+/**
+ * security_detector_neighbors() - Get the mirror of the neighbor tables
+ * @sd: Security detector
+ *
+ * Kept from the neighbor events the detector processes, like the route
+ * mirror. Lives as long as the detector.
+ *
+ * Returns: Mirror or NULL
+ */
+struct neigh_mirror *security_detector_neighbors(struct security_detector *sd);
+
+/**
+ * security_detector_flows() - Get the mirror of the conntrack table
+ * @sd: Security detector
+ *
+ * Kept from the conntrack events the detector processes. Lives as long
+ * as the detector.
+ *
+ * Returns: Mirror or NULL
+ */
+struct ct_mirror *security_detector_flows(struct security_detector *sd);
+
 /**
  * security_detector_stats() - Get detector statistics
  * @sd: Security detector
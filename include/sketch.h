@@ -0,0 +1,108 @@
+/* sketch.h - Fixed memory summaries of event streams
+ *
+ * A count-min sketch estimates how often each key was seen, a
+ * HyperLogLog how many distinct keys were seen. Both take memory fixed
+ * when they are created and O(1) time per key, however many keys the
+ * stream carries, so they stay flat under floods of new addresses.
+ *
+ * Count-min estimates never undercount. With conservative update they
+ * overcount by at most a small multiple of total / width with high
+ * probability. HyperLogLog estimates have a relative standard error of
+ * about 1.04 / sqrt(HYPERLOGLOG_REGISTERS).
+ *
+ * Sketches do not lock, callers serialize access to each sketch.
+ */
+
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Rows of a count-min sketch, each with its own hash of the key */
+#define COUNT_MIN_DEPTH 4
+
+/* Registers of a HyperLogLog, 2^HYPERLOGLOG_PRECISION */
+#define HYPERLOGLOG_PRECISION 8
+#define HYPERLOGLOG_REGISTERS (1 << HYPERLOGLOG_PRECISION)
+
+/* Count-min sketch structure (opaque) */
+struct count_min;
+
+/* HyperLogLog, embeddable, all zero when empty */
+struct hyperloglog {
+	uint8_t registers[HYPERLOGLOG_REGISTERS];
+};
+
+/**
+ * sketch_hash() - Hash a key for a sketch
+ * @key: Key bytes
+ * @len: Key length
+ * @seed: Seed, e.g. the hash of a preceding key part
+ *
+ * Returns: 64-bit hash of @key
+ */
+uint64_t sketch_hash(const void *key, size_t len, uint64_t seed);
+
+/**
+ * count_min_create() - Create a count-min sketch
+ * @width: Counters per row, rounded up to a power of two
+ *
+ * Returns: Pointer to sketch or NULL on error
+ */
+struct count_min *count_min_create(size_t width);
+
+/**
+ * count_min_destroy() - Destroy count-min sketch
+ * @cm: Sketch (can be NULL)
+ */
+void count_min_destroy(struct count_min *cm);
+
+/**
+ * count_min_add() - Count a key
+ * @cm: Sketch
+ * @hash: Hash of the key, see sketch_hash()
+ * @n: Number of times the key was seen
+ *
+ * Returns: Estimated count of the key including @n; the estimate before
+ * was exactly @n less
+ */
+uint32_t count_min_add(struct count_min *cm, uint64_t hash, uint32_t n);
+
+/**
+ * count_min_estimate() - Estimate how often a key was seen
+ * @cm: Sketch
+ * @hash: Hash of the key, see sketch_hash()
+ *
+ * Returns: Estimated count, at least the true count
+ */
+uint32_t count_min_estimate(const struct count_min *cm, uint64_t hash);
+
+/**
+ * count_min_reset() - Forget all counted keys
+ * @cm: Sketch
+ */
+void count_min_reset(struct count_min *cm);
+
+/**
+ * hyperloglog_add() - Add a key to a HyperLogLog
+ * @hll: HyperLogLog
+ * @hash: Hash of the key, see sketch_hash()
+ */
+void hyperloglog_add(struct hyperloglog *hll, uint64_t hash);
+
+/**
+ * hyperloglog_estimate() - Estimate the number of distinct keys added
+ * @hll: HyperLogLog
+ *
+ * Returns: Estimated number of distinct keys
+ */
+double hyperloglog_estimate(const struct hyperloglog *hll);
+
+/**
+ * hyperloglog_reset() - Forget all added keys
+ * @hll: HyperLogLog
+ */
+void hyperloglog_reset(struct hyperloglog *hll);
+
+#endif /* SKETCH_H */
@@ -0,0 +1,88 @@
+/* stack_sampler.h - Sampling profiler of the process's stacks
+ *
+ * A capture arms a CPU time timer for the whole process. Each SIGPROF
+ * it raises records the stack of the thread that was running, so threads
+ * are sampled in proportion to the CPU they use. Stacks are symbolized
+ * once the capture is over and can be written as folded stacks, the input
+ * of flamegraph.pl and most flame graph viewers.
+ */
+
+#ifndef STACK_SAMPLER_H
+#define STACK_SAMPLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Frames kept of each stack, the innermost ones */
+#define STACK_SAMPLER_MAX_DEPTH 32
+
+/* Samples kept of one capture, later ones are counted as dropped */
+#define STACK_SAMPLER_MAX_SAMPLES 32768
+
+/* Sampling rate when none is given, off the beat of periodic timers */
+#define STACK_SAMPLER_DEFAULT_HZ 99
+#define STACK_SAMPLER_MAX_HZ 1000
+
+/* Longest capture */
+#define STACK_SAMPLER_MAX_SECONDS 300
+
+/* Captured stacks (opaque) */
+struct stack_profile;
+
+/**
+ * stack_sampler_capture() - Sample all threads' stacks for a while
+ * @seconds: Length of the capture, 1 to STACK_SAMPLER_MAX_SECONDS
+ * @hz: Samples per CPU second, 0 for STACK_SAMPLER_DEFAULT_HZ
+ *
+ * Blocks the caller for @seconds. SIGPROF and ITIMER_PROF belong to the
+ * process, so there is one capture at a time and nothing else of the
+ * process may use them meanwhile. System calls interrupted by the signal
+ * are restarted where the kernel allows it.
+ *
+ * Returns: Captured stacks, or NULL with errno EINVAL for bad arguments,
+ * EBUSY while another capture runs or ENOMEM
+ */
+struct stack_profile *stack_sampler_capture(unsigned int seconds, unsigned int hz);
+
+/**
+ * stack_profile_samples() - Number of stacks captured
+ * @profile: Captured stacks
+ */
+uint64_t stack_profile_samples(const struct stack_profile *profile);
+
+/**
+ * stack_profile_dropped() - Number of samples beyond STACK_SAMPLER_MAX_SAMPLES
+ * @profile: Captured stacks
+ */
+uint64_t stack_profile_dropped(const struct stack_profile *profile);
+
+/**
+ * stack_profile_share() - Share of samples spent in some functions
+ * @profile: Captured stacks
+ * @name: Part of the function names
+ *
+ * Returns: Percentage of the samples with a frame in a function whose
+ * name contains @name, 0 if there are none
+ */
+double stack_profile_share(const struct stack_profile *profile, const char *name);
+
+/**
+ * stack_profile_folded() - Write the stacks as folded stacks
+ * @profile: Captured stacks
+ * @len: Output for the length, can be NULL
+ *
+ * One "thread;outermost;...;innermost count" line per distinct stack,
+ * the thread named as in /proc. Functions without a symbol are written
+ * as "object+0xoffset" for addr2line.
+ *
+ * Returns: malloc'd NUL terminated text, or NULL on allocation failure
+ */
+char *stack_profile_folded(const struct stack_profile *profile, size_t *len);
+
+/**
+ * stack_profile_free() - Free captured stacks
+ * @profile: Captured stacks, can be NULL
+ */
+void stack_profile_free(struct stack_profile *profile);
+
+#endif /* STACK_SAMPLER_H */
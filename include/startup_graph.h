@@ -0,0 +1,166 @@
+/* startup_graph.h - Dependency ordered, parallel subsystem startup
+ *
+ * Subsystems are added as phases with the phases they need. Running the
+ * graph starts every phase once its dependencies are done, independent
+ * phases on different threads, and records when each started and how
+ * long it took. Lazy phases are left out of the run and started on
+ * first use instead. A phase whose dependency failed is skipped.
+ *
+ * Phases are added and their dependencies set from one thread before
+ * the graph is run; starting, waiting and querying are thread-safe.
+ */
+
+#ifndef STARTUP_GRAPH_H
+#define STARTUP_GRAPH_H
+
+#include <stdint.h>
+
+/* Most phases a graph can hold */
+#define STARTUP_MAX_PHASES 32
+
+/* Phase flags */
+#define STARTUP_LAZY     (1U << 0)  /* Not run by startup_graph_run() */
+#define STARTUP_REQUIRED (1U << 1)  /* Failure fails startup_graph_run() */
+
+struct startup_graph;
+
+/* Phase function, returns 0 on success or a negative error code */
+typedef int (*startup_fn)(void *arg);
+
+enum startup_state {
+	STARTUP_PENDING,
+	STARTUP_RUNNING,
+	STARTUP_DONE,
+	STARTUP_FAILED,
+	STARTUP_SKIPPED,        /* A dependency failed or was skipped */
+};
+
+/**
+ * struct startup_phase_info - Outcome of a phase
+ * @name: Phase name
+ * @state: Current state
+ * @result: Return value of the phase function once it ran
+ * @start_ns: Start, relative to startup_graph_run()
+ * @duration_ns: Run time, 0 until the phase finished
+ * @flags: STARTUP_* flags
+ */
+struct startup_phase_info {
+	const char *name;
+	enum startup_state state;
+	int result;
+	uint64_t start_ns;
+	uint64_t duration_ns;
+	unsigned int flags;
+};
+
+/**
+ * startup_graph_create() - Create an empty graph
+ *
+ * Returns: Graph, or NULL on allocation failure
+ */
+struct startup_graph *startup_graph_create(void);
+
+/**
+ * startup_graph_destroy() - Wait for lazy phases and free the graph
+ * @graph: Graph (can be NULL)
+ */
+void startup_graph_destroy(struct startup_graph *graph);
+
+/**
+ * startup_graph_add() - Add a phase
+ * @graph: Graph
+ * @name: Phase name, kept by reference
+ * @fn: Phase function
+ * @arg: Passed to @fn
+ * @flags: STARTUP_* flags
+ *
+ * Returns: Phase id, -EINVAL for bad arguments, -ENOSPC if the graph is
+ * full, -EBUSY once the graph has been run
+ */
+int startup_graph_add(struct startup_graph *graph, const char *name,
+                      startup_fn fn, void *arg, unsigned int flags);
+
+/**
+ * startup_graph_depend() - Make a phase wait for another
+ * @graph: Graph
+ * @phase: Phase id
+ * @dep: Id of the phase @phase needs
+ *
+ * Returns: 0 on success, -EINVAL for unknown ids, -ELOOP if @dep already
+ * needs @phase, -EBUSY once the graph has been run
+ */
+int startup_graph_depend(struct startup_graph *graph, int phase, int dep);
+
+/**
+ * startup_graph_run() - Run all phases that are not lazy
+ * @graph: Graph
+ * @threads: Most phases to run at once, the calling thread included
+ *
+ * Returns once every phase that is not lazy is done, failed or skipped.
+ *
+ * Returns: 0 on success, result of the first required phase that failed,
+ * or -ECANCELED if a required phase was skipped
+ */
+int startup_graph_run(struct startup_graph *graph, unsigned int threads);
+
+/**
+ * startup_graph_start() - Start a phase and what it needs
+ * @graph: Graph
+ * @phase: Phase id
+ *
+ * Meant for lazy phases on first use. Before startup_graph_run() the
+ * phase simply joins the run; afterwards it runs on a thread of its own,
+ * or on the caller if no thread can be created.
+ *
+ * Returns: 0 if the phase is started or already was, -EINVAL for an
+ * unknown id
+ */
+int startup_graph_start(struct startup_graph *graph, int phase);
+
+/**
+ * startup_graph_wait() - Wait for a started phase to finish
+ * @graph: Graph
+ * @phase: Phase id
+ *
+ * Returns: STARTUP_DONE, STARTUP_FAILED or STARTUP_SKIPPED, or
+ * STARTUP_PENDING if the phase was never started
+ */
+enum startup_state startup_graph_wait(struct startup_graph *graph, int phase);
+
+/**
+ * startup_graph_state() - Current state of a phase
+ * @graph: Graph
+ * @phase: Phase id
+ *
+ * Returns: State, STARTUP_SKIPPED for an unknown id
+ */
+enum startup_state startup_graph_state(struct startup_graph *graph, int phase);
+
+/**
+ * startup_graph_info() - Outcome and timing of a phase
+ * @graph: Graph
+ * @phase: Phase id
+ * @info: Output
+ *
+ * Returns: 0 on success, -EINVAL for an unknown id
+ */
+int startup_graph_info(struct startup_graph *graph, int phase,
+                       struct startup_phase_info *info);
+
+/**
+ * startup_graph_count() - Number of phases in a graph
+ * @graph: Graph
+ *
+ * Returns: Number of phases, ids run from 0 to one less
+ */
+int startup_graph_count(struct startup_graph *graph);
+
+/**
+ * startup_state_name() - Name of a phase state
+ * @state: State
+ *
+ * Returns: Static string
+ */
+const char *startup_state_name(enum startup_state state);
+
+#endif /* STARTUP_GRAPH_H */
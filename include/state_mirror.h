@@ -0,0 +1,215 @@
+/* state_mirror.h - Current neighbor and connection tracking state
+ *
+ * Neighbor and conntrack events are deltas. The mirrors apply them to
+ * tables of the current entries, keyed by interface and address for
+ * neighbors and by the original direction tuple for flows, so the state
+ * of one neighbor or flow is a hash lookup rather than a scan of history.
+ *
+ * Both tables hold a bounded number of entries. The neighbor mirror turns
+ * new entries away once full, so a flood of addresses cannot push out the
+ * neighbors already known. The conntrack mirror evicts the flow updated
+ * least recently, as short lived flows outnumber the long lived ones.
+ *
+ * All functions are safe from any number of threads.
+ */
+
+#ifndef STATE_MIRROR_H
+#define STATE_MIRROR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+/* Forward declarations */
+struct nlmon_neigh_info;
+struct nlmon_ct_info;
+
+/* Mirrored entries when created with a limit of 0 */
+#define NEIGH_MIRROR_DEFAULT_LIMIT 65536
+#define CT_MIRROR_DEFAULT_LIMIT 262144
+
+/* Neighbor of the mirror */
+struct neigh_mirror_entry {
+	int family;                      /* AF_INET or AF_INET6 */
+	int ifindex;                     /* Interface index */
+	char dst[64];                    /* Neighbor address */
+	unsigned char lladdr[6];         /* Link-layer address, zero if never resolved */
+	uint16_t state;                  /* NUD_* state */
+	uint8_t flags;                   /* NTF_* flags */
+	time_t first_seen;               /* When the neighbor was added */
+	time_t updated;                  /* Last event of the neighbor */
+	time_t lladdr_changed;           /* When the link-layer address last changed */
+};
+
+/* Flow of the mirror */
+struct ct_mirror_entry {
+	int family;                      /* AF_INET or AF_INET6 */
+	uint8_t protocol;                /* IPPROTO_* */
+	uint8_t tcp_state;               /* TCP state for TCP flows */
+	char src_addr[64];               /* Original direction source */
+	char dst_addr[64];               /* Original direction destination */
+	uint16_t src_port;
+	uint16_t dst_port;
+	uint32_t mark;                   /* Connection mark */
+	uint64_t packets_orig;
+	uint64_t packets_reply;
+	uint64_t bytes_orig;
+	uint64_t bytes_reply;
+	time_t first_seen;               /* When the flow was added */
+	time_t updated;                  /* Last event of the flow */
+};
+
+/* Called for each entry of a walk, return false to stop */
+typedef bool (*neigh_mirror_walk_fn)(const struct neigh_mirror_entry *entry, void *ctx);
+typedef bool (*ct_mirror_walk_fn)(const struct ct_mirror_entry *entry, void *ctx);
+
+/* Mirrors (opaque) */
+struct neigh_mirror;
+struct ct_mirror;
+
+/**
+ * neigh_mirror_create() - Create an empty neighbor mirror
+ * @max_entries: Most neighbors kept, 0 for NEIGH_MIRROR_DEFAULT_LIMIT
+ *
+ * Returns: Mirror or NULL on error
+ */
+struct neigh_mirror *neigh_mirror_create(size_t max_entries);
+
+/**
+ * neigh_mirror_destroy() - Destroy a neighbor mirror
+ * @mirror: Mirror
+ */
+void neigh_mirror_destroy(struct neigh_mirror *mirror);
+
+/**
+ * neigh_mirror_update() - Apply a neighbor event
+ * @mirror: Mirror
+ * @msg_type: RTM_NEWNEIGH or RTM_DELNEIGH
+ * @neigh: Parsed neighbor
+ * @now: Timestamp of the event
+ * @prev: Output for the entry before the event, can be NULL
+ *
+ * Returns: 1 if the neighbor was known and @prev filled, 0 if it was added,
+ * -ENOENT for the removal of an unknown neighbor, -ENOSPC when full,
+ * -EINVAL, -ENOMEM
+ */
+int neigh_mirror_update(struct neigh_mirror *mirror, uint16_t msg_type,
+                        const struct nlmon_neigh_info *neigh, time_t now,
+                        struct neigh_mirror_entry *prev);
+
+/**
+ * neigh_mirror_lookup() - Get the current state of a neighbor
+ * @mirror: Mirror
+ * @ifindex: Interface index
+ * @addr: IPv4 or IPv6 address
+ * @out: Output for the entry
+ *
+ * Returns: true if the neighbor is known
+ */
+bool neigh_mirror_lookup(struct neigh_mirror *mirror, int ifindex, const char *addr,
+                         struct neigh_mirror_entry *out);
+
+/**
+ * neigh_mirror_walk() - Visit the neighbors, most recently updated first
+ * @mirror: Mirror
+ * @fn: Called for each neighbor, must not modify the mirror
+ * @ctx: Passed to @fn
+ *
+ * Returns: Number of neighbors visited
+ */
+size_t neigh_mirror_walk(struct neigh_mirror *mirror, neigh_mirror_walk_fn fn, void *ctx);
+
+/**
+ * neigh_mirror_restore() - Put back a neighbor of a walk
+ * @mirror: Mirror
+ * @entry: Neighbor as walked, timestamps included
+ *
+ * Restores a mirror saved by a previous process. The restored neighbor
+ * becomes the most recently updated, so restore a walk from its end.
+ *
+ * Returns: 1 if the neighbor was known and replaced, 0 if it was added,
+ * -ENOSPC when full, -EINVAL, -ENOMEM
+ */
+int neigh_mirror_restore(struct neigh_mirror *mirror, const struct neigh_mirror_entry *entry);
+
+/**
+ * neigh_mirror_stats() - Get neighbor mirror statistics
+ * @mirror: Mirror
+ * @entries: Output for the number of neighbors
+ * @rejected: Output for the neighbors turned away when full
+ */
+void neigh_mirror_stats(struct neigh_mirror *mirror, size_t *entries, uint64_t *rejected);
+
+/**
+ * ct_mirror_create() - Create an empty conntrack mirror
+ * @max_entries: Most flows kept, 0 for CT_MIRROR_DEFAULT_LIMIT
+ *
+ * Returns: Mirror or NULL on error
+ */
+struct ct_mirror *ct_mirror_create(size_t max_entries);
+
+/**
+ * ct_mirror_destroy() - Destroy a conntrack mirror
+ * @mirror: Mirror
+ */
+void ct_mirror_destroy(struct ct_mirror *mirror);
+
+/**
+ * ct_mirror_update() - Apply a conntrack event
+ * @mirror: Mirror
+ * @msg_type: IPCTNL_MSG_CT_NEW for new and updated flows, IPCTNL_MSG_CT_DELETE
+ * @ct: Parsed flow
+ * @now: Timestamp of the event
+ *
+ * When full, a new flow takes the place of the one updated least recently.
+ *
+ * Returns: 1 if the flow was known, 0 if it was added, -ENOENT for the
+ * removal of an unknown flow, -EINVAL, -ENOMEM
+ */
+int ct_mirror_update(struct ct_mirror *mirror, uint16_t msg_type,
+                     const struct nlmon_ct_info *ct, time_t now);
+
+/**
+ * ct_mirror_lookup() - Get the current state of a flow
+ * @mirror: Mirror
+ * @tuple: Flow, matched on protocol, addresses and ports
+ * @out: Output for the entry
+ *
+ * Returns: true if the flow is known
+ */
+bool ct_mirror_lookup(struct ct_mirror *mirror, const struct nlmon_ct_info *tuple,
+                      struct ct_mirror_entry *out);
+
+/**
+ * ct_mirror_walk() - Visit the flows, most recently updated first
+ * @mirror: Mirror
+ * @fn: Called for each flow, must not modify the mirror
+ * @ctx: Passed to @fn
+ *
+ * Returns: Number of flows visited
+ */
+size_t ct_mirror_walk(struct ct_mirror *mirror, ct_mirror_walk_fn fn, void *ctx);
+
+/**
+ * ct_mirror_restore() - Put back a flow of a walk
+ * @mirror: Mirror
+ * @entry: Flow as walked, counters and timestamps included
+ *
+ * As neigh_mirror_restore(), restore a walk from its end. When full the
+ * flow updated least recently makes room.
+ *
+ * Returns: 1 if the flow was known and replaced, 0 if it was added,
+ * -EINVAL, -ENOMEM
+ */
+int ct_mirror_restore(struct ct_mirror *mirror, const struct ct_mirror_entry *entry);
+
+/**
+ * ct_mirror_stats() - Get conntrack mirror statistics
+ * @mirror: Mirror
+ * @entries: Output for the number of flows
+ * @evicted: Output for the flows evicted when full
+ */
+void ct_mirror_stats(struct ct_mirror *mirror, size_t *entries, uint64_t *evicted);
+
+#endif /* STATE_MIRROR_H */
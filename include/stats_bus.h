@@ -0,0 +1,215 @@
+/* stats_bus.h - Periodic snapshot of the pipeline's statistics
+ *
+ * The event processor, storage, exporters, netlink limits and plugins
+ * each keep statistics behind their own locks. The bus reads them all
+ * once per interval, on a thread of its own, into one snapshot that any
+ * number of readers copy without taking a lock. The web API, Prometheus
+ * and the CLI read that snapshot instead of polling each module.
+ *
+ * Modules provide a collector each, stats_bus_collect_fn callbacks that
+ * fill their part of the snapshot and set their STATS_HAVE_* bit.
+ */
+
+#ifndef STATS_BUS_H
+#define STATS_BUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "nlmon_nl_limits.h"
+
+#define STATS_BUS_DEFAULT_INTERVAL_MS 1000
+#define STATS_BUS_MAX_SOURCES 16
+#define STATS_BUS_MAX_SUBSCRIBERS 8
+#define STATS_BUS_MAX_PLUGINS 16
+#define STATS_BUS_MAX_EXPORTS 16  /* Room for each enum export_target */
+#define STATS_BUS_MAX_BATCHES 16
+
+/* Parts of a snapshot filled in */
+#define STATS_HAVE_EVENTS       (1u << 0)
+#define STATS_HAVE_THREAD_POOL  (1u << 1)
+#define STATS_HAVE_STORAGE      (1u << 2)
+#define STATS_HAVE_EXPORT       (1u << 3)
+#define STATS_HAVE_NETLINK      (1u << 4)
+#define STATS_HAVE_PLUGINS      (1u << 5)
+#define STATS_HAVE_BATCHING     (1u << 6)
+#define STATS_HAVE_HUGEPAGES    (1u << 7)
+
+/* Per export queue figures, as struct export_queue_stats; not that struct
+ * itself so that this header does not pull in every exporter's */
+struct stats_export {
+	uint64_t queued;
+	uint64_t exported;
+	uint64_t failed;
+	uint64_t dropped;
+	uint64_t sampled;
+	size_t queue_depth;
+	uint64_t lag_us;
+	uint64_t lag_max_us;
+};
+
+/* Per plugin figures */
+struct stats_plugin {
+	char name[64];
+	uint64_t events_processed;
+	uint64_t events_dropped;
+	uint64_t budget_violations;
+	size_t queue_depth;
+	double latency_p99_us;
+	bool suspended;
+};
+
+/* Per stage adaptive batching figures, as struct adaptive_batch_stats */
+struct stats_batch {
+	char name[32];
+	size_t size;
+	uint64_t linger_us;
+	uint64_t target_us;
+	uint64_t latency_us;
+	uint64_t batches;
+	uint64_t items;
+	uint64_t over_target;
+};
+
+/* Statistics of the whole pipeline at one point in time */
+struct nlmon_stats_snapshot {
+	uint64_t generation;            /* 1 for the first snapshot, then up by one */
+	uint64_t timestamp_ms;          /* Wall clock time of the collection */
+	uint64_t collect_ns;            /* Time the collectors took */
+	uint32_t have;                  /* STATS_HAVE_* of the parts filled in */
+	
+	struct {
+		uint64_t submitted;
+		uint64_t processed;
+		uint64_t dropped;
+		uint64_t rate_limited;
+		size_t queue_size;
+		size_t pool_usage;
+	} events;
+	
+	struct {
+		uint64_t submitted;
+		uint64_t completed;
+		uint64_t rejected;
+		size_t threads;
+		size_t pending;
+	} thread_pool;
+	
+	struct {
+		size_t buffer_size;
+		size_t buffer_capacity;
+		uint64_t db_event_count;
+		uint64_t db_size_bytes;
+		uint64_t audit_entries;
+	} storage;
+	
+	uint32_t exports_enabled;       /* Bit per enum export_target with a queue */
+	struct stats_export exports[STATS_BUS_MAX_EXPORTS];
+	
+	struct nlmon_nl_resource_stats netlink;
+	
+	size_t num_plugins;             /* At most STATS_BUS_MAX_PLUGINS */
+	struct stats_plugin plugins[STATS_BUS_MAX_PLUGINS];
+	
+	size_t num_batches;             /* At most STATS_BUS_MAX_BATCHES */
+	struct stats_batch batches[STATS_BUS_MAX_BATCHES];
+	
+	struct {
+		size_t regions;             /* Arrays mapped by huge_alloc */
+		size_t bytes;
+		size_t huge_bytes;          /* Of them backed by huge pages */
+	} hugepages;
+};
+
+/* Fill a module's part of @snapshot, called on the bus thread */
+typedef void (*stats_bus_collect_fn)(struct nlmon_stats_snapshot *snapshot, void *ctx);
+
+/* Told of each snapshot once published, on the bus thread */
+typedef void (*stats_bus_notify_fn)(const struct nlmon_stats_snapshot *snapshot, void *ctx);
+
+/* Stats bus (opaque) */
+struct stats_bus;
+
+/**
+ * stats_bus_create() - Create a stats bus
+ * @interval_ms: Time between snapshots, 0 for STATS_BUS_DEFAULT_INTERVAL_MS
+ *
+ * Returns: Bus handle or NULL on error
+ */
+struct stats_bus *stats_bus_create(unsigned int interval_ms);
+
+/**
+ * stats_bus_destroy() - Stop the bus thread and free the bus
+ * @bus: Bus handle (can be NULL)
+ */
+void stats_bus_destroy(struct stats_bus *bus);
+
+/**
+ * stats_bus_add_source() - Add a collector
+ * @bus: Bus handle
+ * @collect: Collector
+ * @ctx: Collector argument, the module's handle
+ *
+ * Sources are added before stats_bus_start(). Collectors run in the order
+ * they were added.
+ *
+ * Returns: 0 on success, -1 if the bus has started or is full
+ */
+int stats_bus_add_source(struct stats_bus *bus, stats_bus_collect_fn collect, void *ctx);
+
+/**
+ * stats_bus_subscribe() - Have snapshots pushed as they are published
+ * @bus: Bus handle
+ * @notify: Callback
+ * @ctx: Callback argument
+ *
+ * For readers that update something of their own per snapshot, such as
+ * Prometheus gauges. Like sources, subscribers are added before starting.
+ *
+ * Returns: 0 on success, -1 if the bus has started or is full
+ */
+int stats_bus_subscribe(struct stats_bus *bus, stats_bus_notify_fn notify, void *ctx);
+
+/**
+ * stats_bus_start() - Start publishing
+ * @bus: Bus handle
+ *
+ * The first snapshot is published before this returns, the next ones
+ * every interval from the bus thread.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int stats_bus_start(struct stats_bus *bus);
+
+/**
+ * stats_bus_publish() - Collect and publish a snapshot now
+ * @bus: Bus handle
+ *
+ * The bus thread does this every interval, it is exposed for callers
+ * that want a fresh snapshot, or drive the bus without its thread.
+ */
+void stats_bus_publish(struct stats_bus *bus);
+
+/**
+ * stats_bus_read() - Copy the latest snapshot
+ * @bus: Bus handle
+ * @snapshot: Output
+ *
+ * Lock free and safe from any thread, it may retry if a snapshot is
+ * published while copying.
+ *
+ * Returns: true on success, false if nothing was published yet
+ */
+bool stats_bus_read(struct stats_bus *bus, struct nlmon_stats_snapshot *snapshot);
+
+/**
+ * stats_bus_generation() - Generation of the latest snapshot
+ * @bus: Bus handle
+ *
+ * Cheap enough to version cached responses with.
+ *
+ * Returns: Generation, 0 before the first snapshot
+ */
+uint64_t stats_bus_generation(struct stats_bus *bus);
+
+#endif /* STATS_BUS_H */
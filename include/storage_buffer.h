@@ -2,6 +2,8 @@
  *
  * Provides a circular buffer for storing recent network events with
  * thread-safe access, overflow handling, and query API for CLI display.
+ * One thread at a time adds or clears; reads take no lock and never
+ * delay adding, so they may run from any number of threads.
  */
 
 #ifndef STORAGE_BUFFER_H
@@ -11,9 +13,11 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include "memory_governor.h"
 
-/* Forward declaration */
+/* Forward declarations */
 struct nlmon_event;
+struct filter_node;
 
 /* Storage buffer structure (opaque) */
 struct storage_buffer;
@@ -25,10 +29,29 @@ struct buffer_query_filter {
 	uint16_t message_type;          /* Message type (0=any) */
 	uint64_t start_time;            /* Start timestamp (0=any) */
 	uint64_t end_time;              /* End timestamp (0=any) */
+	const struct filter_node *expr; /* Filter expression on the header columns (NULL=any) */
 	size_t max_results;             /* Maximum results (0=unlimited) */
 };
 
-/* Query result callback */
+/* Header fields of a stored event, copied without its data */
+struct buffer_event_header {
+	uint64_t timestamp;
+	uint64_t sequence;
+	uint32_t event_type;
+	uint16_t message_type;
+	char interface[16];             /* Not NUL terminated if all 16 are used */
+};
+
+/* History statistics, see storage_buffer_set_history() */
+struct buffer_history_stats {
+	size_t blocks;                  /* Sealed blocks */
+	uint64_t events;                /* Events in them */
+	size_t bytes;                   /* Bytes held, deflated */
+	uint64_t raw_bytes;             /* Bytes encoded before deflating */
+	size_t max_bytes;               /* Bytes kept at most, lowered under pressure */
+};
+
+/* Query result callback, the event is only valid until it returns */
 typedef void (*buffer_query_callback_t)(struct nlmon_event *event, void *ctx);
 
 /**
@@ -39,6 +62,19 @@ typedef void (*buffer_query_callback_t)(struct nlmon_event *event, void *ctx);
  */
 struct storage_buffer *storage_buffer_create(size_t capacity);
 
+/**
+ * storage_buffer_create_indexed() - Create storage buffer with indexes
+ * @capacity: Maximum number of events to store
+ *
+ * Like storage_buffer_create(), but also keeps posting lists of the
+ * events of each interface and event type, for 16 more bytes per event.
+ * Queries for one interface or event type then visit only its events
+ * instead of scanning the buffer.
+ *
+ * Returns: Pointer to storage buffer or NULL on error
+ */
+struct storage_buffer *storage_buffer_create_indexed(size_t capacity);
+
 /**
  * storage_buffer_destroy() - Destroy storage buffer
  * @sb: Storage buffer
@@ -48,7 +84,10 @@ void storage_buffer_destroy(struct storage_buffer *sb);
 /**
  * storage_buffer_add() - Add event to buffer
  * @sb: Storage buffer
- * @event: Event to add (will be copied)
+ * @event: Event to add
+ *
+ * Refcounted events (see nlmon_event_share()) are stored by reference,
+ * other events are copied once into a refcounted event.
  *
  * Returns: true on success, false on error
  * Note: Oldest event is automatically removed if buffer is full
@@ -61,6 +100,9 @@ bool storage_buffer_add(struct storage_buffer *sb, struct nlmon_event *event);
  * @index: Event index (0 = oldest, size-1 = newest)
  * @event: Output buffer for event
  *
+ * The event gets its own copy of the data, released with
+ * nlmon_event_free_data().
+ *
  * Returns: true if event found, false otherwise
  */
 bool storage_buffer_get(struct storage_buffer *sb, size_t index, 
@@ -72,11 +114,60 @@ bool storage_buffer_get(struct storage_buffer *sb, size_t index,
  * @count: Number of events to retrieve
  * @events: Output array for events (must be allocated by caller)
  *
+ * Data is copied as by storage_buffer_get().
+ *
  * Returns: Number of events retrieved
  */
 size_t storage_buffer_get_latest(struct storage_buffer *sb, size_t count,
                                  struct nlmon_event *events);
 
+/**
+ * storage_buffer_get_headers() - Get headers of the most recent events
+ * @sb: Storage buffer
+ * @count: Number of headers to retrieve
+ * @headers: Output array for headers, newest first
+ *
+ * Copies only the header fields, neither the event nor its data is
+ * referenced, which makes this the cheapest way to list recent events.
+ *
+ * Returns: Number of headers retrieved
+ */
+size_t storage_buffer_get_headers(struct storage_buffer *sb, size_t count,
+                                  struct buffer_event_header *headers);
+
+/**
+ * storage_buffer_get_headers_before() - Get headers of events before a key
+ * @sb: Storage buffer
+ * @timestamp: Timestamp of the key
+ * @sequence: Sequence number of the key
+ * @count: Number of headers to retrieve
+ * @headers: Output array for headers, newest first
+ *
+ * Returns the headers of the newest events ordered before (@timestamp,
+ * @sequence), for keyset pagination: pass the key of the last header of
+ * a page to get the next one. The key is found by binary search, which
+ * relies on events being added in timestamp order. UINT64_MAX for both
+ * starts at the newest event.
+ *
+ * Returns: Number of headers retrieved
+ */
+size_t storage_buffer_get_headers_before(struct storage_buffer *sb,
+                                         uint64_t timestamp, uint64_t sequence,
+                                         size_t count, struct buffer_event_header *headers);
+
+/**
+ * storage_buffer_get_ref() - Get a reference to an event by index
+ * @sb: Storage buffer
+ * @index: Event index (0 = oldest, size-1 = newest)
+ *
+ * Unlike storage_buffer_get() the event and its data are not copied.
+ * The event stays valid after it is evicted from the buffer and must
+ * be treated as read-only.
+ *
+ * Returns: Event reference, released with nlmon_event_put(), or NULL
+ */
+struct nlmon_event *storage_buffer_get_ref(struct storage_buffer *sb, size_t index);
+
 /**
  * storage_buffer_query() - Query buffer with filter
  * @sb: Storage buffer
@@ -84,6 +175,22 @@ size_t storage_buffer_get_latest(struct storage_buffer *sb, size_t count,
  * @callback: Callback for each matching event
  * @ctx: Context to pass to callback
  *
+ * The filter is matched on the stored header columns, only matching
+ * events are passed to @callback, oldest first. Blocks of events whose
+ * summary rules out a match are skipped, and indexed buffers follow the
+ * posting list of the interface or event type filtered on. Events
+ * evicted while the query runs are skipped.
+ *
+ * Of @filter's expression, the comparisons of header columns (interface,
+ * event and message type, timestamp, sequence and namespace) are decided
+ * on the stored row. Events it depends on other fields for are passed on,
+ * the caller evaluates the expression on them unless
+ * storage_buffer_expr_pushable() holds.
+ *
+ * With a history, its events come first. They are decoded into a
+ * temporary event that has the header, netlink fields and data of the
+ * original, but no parsed attributes or raw message.
+ *
  * Returns: Number of matching events
  */
 size_t storage_buffer_query(struct storage_buffer *sb,
@@ -91,6 +198,27 @@ size_t storage_buffer_query(struct storage_buffer *sb,
                             buffer_query_callback_t callback,
                             void *ctx);
 
+/**
+ * storage_buffer_expr_pushable() - Whether header columns decide an expression
+ * @expr: Filter expression AST
+ *
+ * Returns: True if storage_buffer_header_match() and storage_buffer_query()
+ *          decide @expr exactly, false if it needs fields headers lack
+ */
+bool storage_buffer_expr_pushable(const struct filter_node *expr);
+
+/**
+ * storage_buffer_header_match() - Match a filter expression on a header
+ * @expr: Filter expression AST
+ * @header: Event header
+ *
+ * Parts of @expr on fields the header lacks are taken to match.
+ *
+ * Returns: False if @expr rules the event out
+ */
+bool storage_buffer_header_match(const struct filter_node *expr,
+                                 const struct buffer_event_header *header);
+
 /**
  * storage_buffer_size() - Get current number of events in buffer
  * @sb: Storage buffer
@@ -125,4 +253,73 @@ void storage_buffer_stats(struct storage_buffer *sb,
                          unsigned long *total_overflows,
                          unsigned long *peak_usage);
 
+/**
+ * storage_buffer_set_limit() - Keep fewer events than the capacity
+ * @sb: Storage buffer
+ * @max_events: Events to keep, 0 (or the capacity) to lift the limit
+ *
+ * Evicts the oldest events down to the limit right away, and from then on
+ * drops the oldest event whenever an add would go over it. Memory of the
+ * columns stays allocated, only the events are released.
+ */
+void storage_buffer_set_limit(struct storage_buffer *sb, size_t max_events);
+
+/**
+ * storage_buffer_limit() - Events kept at most
+ * @sb: Storage buffer
+ *
+ * Returns: The limit, or the capacity if none is set
+ */
+size_t storage_buffer_limit(struct storage_buffer *sb);
+
+/**
+ * storage_buffer_memory() - Bytes held
+ * @sb: Storage buffer
+ *
+ * Counts the columns, the history and every event held with its data,
+ * including events shared with other holders.
+ *
+ * Returns: Bytes
+ */
+size_t storage_buffer_memory(struct storage_buffer *sb);
+
+/**
+ * storage_buffer_memory_usage() - Memory governor usage report
+ * @ctx: Storage buffer
+ *
+ * Returns: storage_buffer_memory()
+ */
+size_t storage_buffer_memory_usage(void *ctx);
+
+/**
+ * storage_buffer_memory_respond() - Memory governor pressure response
+ * @ctx: Storage buffer
+ * @level: Pressure level
+ * @target: Bytes to stay within
+ *
+ * From HIGH on, trims the history to a quarter of @target and limits the
+ * events to what fits the rest at their mean size; lower levels lift both.
+ */
+void storage_buffer_memory_respond(void *ctx, enum memory_pressure level, size_t target);
+
+/**
+ * storage_buffer_set_history() - Keep evicted events in compressed blocks
+ * @sb: Storage buffer
+ * @max_bytes: Bytes of history to keep, 0 to drop it
+ *
+ * Events evicted from then on are sealed in blocks of 1024, encoded as
+ * deltas and deflated, so the history holds many more events than the
+ * same memory in the buffer. Once over @max_bytes the oldest blocks are
+ * dropped. storage_buffer_query() searches the history, the other getters
+ * only the buffer.
+ */
+void storage_buffer_set_history(struct storage_buffer *sb, size_t max_bytes);
+
+/**
+ * storage_buffer_history_stats() - Get history statistics
+ * @sb: Storage buffer
+ * @stats: Output statistics
+ */
+void storage_buffer_history_stats(struct storage_buffer *sb, struct buffer_history_stats *stats);
+
 #endif /* STORAGE_BUFFER_H */
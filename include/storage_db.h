@@ -2,6 +2,17 @@
  *
  * Provides persistent storage for network events with indexing,
  * batched inserts, query API with filtering, and database maintenance.
+ * With an async writer, inserts only queue the event; a writer thread
+ * owned by the database inserts queued events and commits them in
+ * groups, so a slow commit never stalls the inserting thread. Group
+ * size and the time a group waits for more events adapt to the commit
+ * latency, within commit_count and commit_interval_ms.
+ *
+ * Partitioned databases keep the events of each partition_span long
+ * range of timestamps in a table of their own, e.g. per hour or day.
+ * Retention then drops whole tables instead of deleting rows, and
+ * queries only read the tables overlapping their time range. The view
+ * events_all unions all tables for external readers.
  */
 
 #ifndef STORAGE_DB_H
@@ -11,8 +22,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-/* Forward declaration */
+/* Forward declarations */
 struct nlmon_event;
+struct filter_node;
 
 /* Database handle (opaque) */
 struct storage_db;
@@ -24,6 +36,38 @@ struct storage_db_config {
 	size_t cache_size_kb;           /* SQLite cache size in KB */
 	bool enable_wal;                /* Enable Write-Ahead Logging */
 	int busy_timeout_ms;            /* Busy timeout in milliseconds */
+	uint64_t partition_span;        /* Timestamp units per partition table (0=one table) */
+	int wal_autocheckpoint;         /* WAL pages before a commit checkpoints (0=default, -1=never) */
+	
+	/* Async writer */
+	bool async_writer;              /* Insert from a writer thread */
+	size_t queue_size;              /* Events queued for the writer (0=auto) */
+	size_t commit_count;            /* Commit after at most this many events (0=auto) */
+	uint32_t commit_interval_ms;    /* ...or at most this long after the first (0=auto) */
+	uint32_t commit_latency_ms;     /* Commit latency aimed for (0=2*commit_interval_ms) */
+};
+
+/* Buckets of the writer histograms, bucket i > 0 counts [2^(i-1), 2^i) */
+#define STORAGE_DB_HIST_BUCKETS 24
+
+/* Async writer statistics */
+struct storage_db_writer_stats {
+	uint64_t queued;                /* Events accepted by storage_db_insert() */
+	uint64_t dropped;               /* Events refused with the queue full */
+	uint64_t committed;             /* Events committed */
+	uint64_t failed;                /* Events lost to failed inserts or commits */
+	uint64_t commits;
+	size_t queue_depth;             /* Events queued now */
+	uint64_t commit_latency_max_us;
+	uint64_t commit_latency_us[STORAGE_DB_HIST_BUCKETS];  /* Commits by duration */
+	uint64_t queue_depth_hist[STORAGE_DB_HIST_BUCKETS];   /* Commits by depth at commit */
+};
+
+/* Position of an event in timestamp order, for keyset pagination */
+struct db_query_cursor {
+	uint64_t table;                 /* Table holding the event, opaque */
+	uint64_t timestamp;
+	int64_t id;                     /* Row id within the table */
 };
 
 /* Query filter for database queries */
@@ -34,10 +78,13 @@ struct db_query_filter {
 	const char *namespace;          /* Namespace (NULL=any) */
 	uint64_t start_time;            /* Start timestamp (0=any) */
 	uint64_t end_time;              /* End timestamp (0=any) */
+	const struct filter_node *expr; /* Filter expression, pushed down where stored (NULL=any) */
 	size_t limit;                   /* Result limit (0=unlimited) */
 	size_t offset;                  /* Result offset */
 	const char *order_by;           /* Order by field (NULL=timestamp) */
 	bool descending;                /* Descending order */
+	bool after_cursor;              /* Resume after cursor instead of offset */
+	struct db_query_cursor cursor;  /* Set to the last event of a query */
 };
 
 /* Query result callback */
@@ -62,7 +109,10 @@ void storage_db_close(struct storage_db *db);
  * @db: Database handle
  * @event: Event to insert
  *
- * Returns: true on success, false on error
+ * With an async writer the event is queued and inserted later; the
+ * event is shared rather than copied if it is refcounted.
+ *
+ * Returns: true on success, false on error or if the writer queue is full
  * Note: May be batched for performance
  */
 bool storage_db_insert(struct storage_db *db, struct nlmon_event *event);
@@ -71,6 +121,9 @@ bool storage_db_insert(struct storage_db *db, struct nlmon_event *event);
  * storage_db_flush() - Flush pending batched inserts
  * @db: Database handle
  *
+ * With an async writer, waits until the events queued before the call
+ * are committed.
+ *
  * Returns: true on success, false on error
  */
 bool storage_db_flush(struct storage_db *db);
@@ -82,6 +135,24 @@ bool storage_db_flush(struct storage_db *db);
  * @callback: Callback for each matching event
  * @ctx: Context to pass to callback
  *
+ * The database is locked while the query runs, @callback must not call
+ * back into @db.
+ *
+ * Queries in timestamp order set @filter->cursor to their last event.
+ * The next page is then read with @filter->after_cursor set, which seeks
+ * in the timestamp index where an offset would read and drop all events
+ * before it. Queries in other orders cannot use cursors.
+ *
+ * Interface patterns without % or _ wildcards match the name exactly,
+ * the literal prefix of other patterns matches case-sensitively.
+ *
+ * The comparisons of @filter's expression on stored columns (interface,
+ * namespace, event and message type, timestamp and sequence) become
+ * parameterized conditions of the WHERE clause. Parts on other fields,
+ * and regular expressions, are left out, so the query returns a superset
+ * the caller evaluates the expression on unless storage_db_expr_pushable()
+ * holds. Limit and offset then count rows of that superset.
+ *
  * Returns: Number of matching events, or -1 on error
  */
 int storage_db_query(struct storage_db *db,
@@ -89,6 +160,15 @@ int storage_db_query(struct storage_db *db,
                      db_query_callback_t callback,
                      void *ctx);
 
+/**
+ * storage_db_expr_pushable() - Whether a query decides an expression
+ * @expr: Filter expression AST
+ *
+ * Returns: True if storage_db_query() with @expr returns exactly the
+ *          events it matches, false if the caller has to evaluate it
+ */
+bool storage_db_expr_pushable(const struct filter_node *expr);
+
 /**
  * storage_db_count() - Count events matching filter
  * @db: Database handle
@@ -98,11 +178,29 @@ int storage_db_query(struct storage_db *db,
  */
 int storage_db_count(struct storage_db *db, struct db_query_filter *filter);
 
+/**
+ * storage_db_explain() - Describe how a query would run
+ * @db: Database handle
+ * @filter: Query filter (NULL for all events)
+ * @plan: Output for the EXPLAIN QUERY PLAN lines, one per line
+ * @size: Size of @plan
+ *
+ * Explains the statement storage_db_query() would run first, on the
+ * newest table in descending order and on the oldest otherwise.
+ *
+ * Returns: Length of the plan, or -1 on error
+ */
+int storage_db_explain(struct storage_db *db, struct db_query_filter *filter,
+                       char *plan, size_t size);
+
 /**
  * storage_db_delete_before() - Delete events before timestamp
  * @db: Database handle
  * @timestamp: Timestamp threshold
  *
+ * Partitions wholly before @timestamp are dropped, only the partition
+ * holding it has rows deleted.
+ *
  * Returns: Number of deleted events, or -1 on error
  */
 int storage_db_delete_before(struct storage_db *db, uint64_t timestamp);
@@ -124,6 +222,34 @@ int storage_db_delete_oldest(struct storage_db *db, size_t keep_count);
  */
 bool storage_db_vacuum(struct storage_db *db);
 
+/**
+ * storage_db_incremental_vacuum() - Return free pages to the file system
+ * @db: Database handle
+ * @max_pages: Most pages to return (0=all)
+ *
+ * Only databases using incremental auto-vacuum, which partitioned
+ * databases are created with, have pages to return. Unlike
+ * storage_db_vacuum() the work is bounded by @max_pages, so it can run
+ * in small steps between inserts.
+ *
+ * Returns: Number of pages returned, or -1 on error
+ */
+int storage_db_incremental_vacuum(struct storage_db *db, unsigned int max_pages);
+
+/**
+ * storage_db_wal_checkpoint() - Write WAL frames back to the database
+ * @db: Database handle
+ * @wal_frames: Output for frames in the WAL (can be NULL)
+ * @checkpointed_frames: Output for frames written back (can be NULL)
+ *
+ * Runs a passive checkpoint, which never waits for readers or writers
+ * and writes back what it can. Both outputs are 0 without WAL.
+ *
+ * Returns: true on success, false on error
+ */
+bool storage_db_wal_checkpoint(struct storage_db *db, int *wal_frames,
+                               int *checkpointed_frames);
+
 /**
  * storage_db_analyze() - Analyze database for query optimization
  * @db: Database handle
@@ -146,4 +272,14 @@ bool storage_db_get_stats(struct storage_db *db,
                          uint64_t *db_size_bytes,
                          uint64_t *page_count);
 
+/**
+ * storage_db_get_writer_stats() - Get async writer statistics
+ * @db: Database handle
+ * @stats: Output for statistics
+ *
+ * Returns: true on success, false if @db has no async writer
+ */
+bool storage_db_get_writer_stats(struct storage_db *db,
+                                 struct storage_db_writer_stats *stats);
+
 #endif /* STORAGE_DB_H */
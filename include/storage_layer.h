@@ -2,6 +2,15 @@
  *
  * Provides a unified interface to all storage backends including
  * memory buffer, database, audit log, and retention policy.
+ *
+ * The database and the segment log may each store a sample of the
+ * events by event type, see event_sampler.h, recording the sample weight
+ * of every event stored. The memory buffer and the audit log always get
+ * every event.
+ *
+ * A rollup may count the events per event type and interface at fixed
+ * resolutions, see storage_rollup.h, for dashboards that chart rates
+ * without reading the events back.
  */
 
 #ifndef STORAGE_LAYER_H
@@ -11,22 +20,45 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <time.h>
+#include "event_sampler.h"
+#include "storage_rollup.h"
 
 /* Forward declarations */
 struct nlmon_event;
 struct storage_buffer;
 struct storage_db;
+struct storage_log;
 struct audit_log;
 struct retention_policy;
+struct nlmon_stats_snapshot;
 
 /* Storage layer handle (opaque) */
 struct storage_layer;
 
+/* Statistics of one pipeline stage */
+struct storage_stage_stats {
+	const char *name;               /* "database", "log" or "audit" */
+	uint64_t written;               /* Events written to the backend */
+	uint64_t failed;                /* Events the backend refused */
+	uint64_t sampled;               /* Events left out by sampling */
+	uint64_t flushes;
+	uint64_t flush_failures;
+	uint64_t stalls;                /* Stores that waited for room in the queue */
+	uint64_t durable;               /* Sequence flushed up to */
+	size_t queue_depth;
+};
+
 /* Storage layer configuration */
 struct storage_layer_config {
 	/* Memory buffer */
 	bool enable_buffer;
 	size_t buffer_capacity;
+	bool buffer_indexed;            /* Index by interface and event type */
+	size_t buffer_history_bytes;    /* Compressed history of evicted events (0=none) */
+	
+	/* Rollup of event counts, every event stored */
+	bool enable_rollup;
+	struct storage_rollup_config rollup;
 	
 	/* Database */
 	bool enable_database;
@@ -34,6 +66,16 @@ struct storage_layer_config {
 	size_t db_batch_size;
 	size_t db_cache_size_kb;
 	bool db_enable_wal;
+	bool db_async_writer;           /* Insert from the database's writer thread */
+	uint64_t db_partition_span;     /* Timestamp units per table (0=one table) */
+	struct event_sampler_config db_sampling;
+	
+	/* Segment log */
+	bool enable_log;
+	const char *log_dir;
+	size_t log_segment_size;        /* Bytes per segment file (0=default) */
+	size_t log_max_segments;        /* Segments kept (0=unlimited) */
+	struct event_sampler_config log_sampling;
 	
 	/* Audit log */
 	bool enable_audit_log;
@@ -42,6 +84,12 @@ struct storage_layer_config {
 	size_t audit_max_file_size;
 	size_t audit_max_rotations;
 	bool audit_sync_writes;
+	size_t audit_batch_size;        /* Entries per write batch (0=1) */
+	size_t audit_checkpoint_interval; /* Entries per Merkle checkpoint (0=none) */
+	
+	/* Pipeline */
+	bool pipelined;                 /* Database, log and audit written by their own threads */
+	size_t pipeline_queue_size;     /* Events queued per stage (0=auto) */
 	
 	/* Retention policy */
 	bool enable_retention;
@@ -50,6 +98,9 @@ struct storage_layer_config {
 	size_t retention_max_db_size_mb;
 	time_t retention_cleanup_interval;
 	bool retention_cleanup_on_startup;
+	const char *retention_cpus;       /* CPU list of the cleanup thread (NULL=any) */
+	uint32_t retention_maintenance_interval_ms; /* Vacuum and WAL checkpoint interval (0=none) */
+	size_t retention_busy_queue_depth; /* Writer queue depth deferring maintenance (0=never) */
 };
 
 /**
@@ -72,6 +123,10 @@ void storage_layer_destroy(struct storage_layer *sl);
  * @event: Event to store
  * @is_security_event: Whether this is a security event
  *
+ * The event gets the next sequence number, see storage_layer_sequence().
+ * Pipelined layers write it to the memory buffer and queue it for the
+ * other backends, waiting only if a stage's queue is full.
+ *
  * Returns: true on success, false on error
  */
 bool storage_layer_store_event(struct storage_layer *sl,
@@ -86,6 +141,14 @@ bool storage_layer_store_event(struct storage_layer *sl,
  */
 struct storage_buffer *storage_layer_get_buffer(struct storage_layer *sl);
 
+/**
+ * storage_layer_get_rollup() - Get rollup handle
+ * @sl: Storage layer handle
+ *
+ * Returns: Rollup handle or NULL if not enabled
+ */
+struct storage_rollup *storage_layer_get_rollup(struct storage_layer *sl);
+
 /**
  * storage_layer_get_database() - Get database handle
  * @sl: Storage layer handle
@@ -94,6 +157,14 @@ struct storage_buffer *storage_layer_get_buffer(struct storage_layer *sl);
  */
 struct storage_db *storage_layer_get_database(struct storage_layer *sl);
 
+/**
+ * storage_layer_get_log() - Get segment log handle
+ * @sl: Storage layer handle
+ *
+ * Returns: Segment log handle or NULL if not enabled
+ */
+struct storage_log *storage_layer_get_log(struct storage_layer *sl);
+
 /**
  * storage_layer_get_audit_log() - Get audit log handle
  * @sl: Storage layer handle
@@ -106,10 +177,58 @@ struct audit_log *storage_layer_get_audit_log(struct storage_layer *sl);
  * storage_layer_flush() - Flush all pending writes
  * @sl: Storage layer handle
  *
+ * Pipelined layers wait until the stages flushed every event stored
+ * before the call. Events a sampling reservoir holds are not waited
+ * for, a stage writes them when their interval ends; layers without a
+ * pipeline write them here.
+ *
  * Returns: true on success, false on error
  */
 bool storage_layer_flush(struct storage_layer *sl);
 
+/**
+ * storage_layer_sequence() - Sequence number of the last stored event
+ * @sl: Storage layer handle
+ *
+ * Returns: Sequence number, 0 before the first event
+ */
+uint64_t storage_layer_sequence(struct storage_layer *sl);
+
+/**
+ * storage_layer_durable_sequence() - Sequence number flushed up to
+ * @sl: Storage layer handle
+ *
+ * Events up to this one have been written and flushed by every backend.
+ *
+ * Returns: Sequence number
+ */
+uint64_t storage_layer_durable_sequence(struct storage_layer *sl);
+
+/**
+ * storage_layer_wait_durable() - Wait until an event is flushed
+ * @sl: Storage layer handle
+ * @sequence: Sequence number of the event
+ * @timeout_ms: Longest wait, negative to wait without limit
+ *
+ * Stages in the middle of a long run flush early for a waiter. Layers
+ * without a pipeline flush on the caller instead. A failed flush ends
+ * the wait.
+ *
+ * Returns: true once @sequence is durable, false on timeout or failure
+ */
+bool storage_layer_wait_durable(struct storage_layer *sl, uint64_t sequence, int timeout_ms);
+
+/**
+ * storage_layer_get_stage_stats() - Get pipeline stage statistics
+ * @sl: Storage layer handle
+ * @stats: Output array
+ * @max: Size of @stats
+ *
+ * Returns: Number of stages filled in, 0 unless pipelined
+ */
+size_t storage_layer_get_stage_stats(struct storage_layer *sl,
+                                     struct storage_stage_stats *stats, size_t max);
+
 /**
  * storage_layer_enforce_retention() - Manually enforce retention policy
  * @sl: Storage layer handle
@@ -136,4 +255,13 @@ bool storage_layer_get_stats(struct storage_layer *sl,
                             uint64_t *db_size_bytes,
                             uint64_t *audit_entries);
 
+/**
+ * storage_layer_collect_stats() - Stats bus collector
+ * @snapshot: Snapshot to fill
+ * @ctx: Storage layer
+ *
+ * Fills the storage part, see stats_bus_add_source().
+ */
+void storage_layer_collect_stats(struct nlmon_stats_snapshot *snapshot, void *ctx);
+
 #endif /* STORAGE_LAYER_H */
@@ -0,0 +1,207 @@
+/* storage_log.h - Append-only segment log storage backend
+ *
+ * Writes events as binary records into preallocated, memory-mapped
+ * segment files, a lighter alternative to the database for high event
+ * rates. Each record carries a CRC32C, checked when a segment left
+ * unsealed by a crash is recovered. Each segment keeps a sparse index of
+ * record blocks with their time ranges, stored in the segment when it is
+ * sealed, so cursors start reading near their start time. Retention only
+ * ever deletes whole segments.
+ *
+ * Cursors read records in place from the mapped segments, without
+ * copying, while events are appended.
+ */
+
+#ifndef STORAGE_LOG_H
+#define STORAGE_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Forward declarations */
+struct nlmon_event;
+
+/* Defaults for zero configuration fields */
+#define STORAGE_LOG_DEFAULT_SEGMENT_SIZE (64 * 1024 * 1024)
+#define STORAGE_LOG_DEFAULT_INDEX_INTERVAL 256
+
+/* Segment log configuration, zero fields take the defaults */
+struct storage_log_config {
+	const char *dir;                /* Directory of the segment files, created if missing */
+	size_t segment_size;            /* Bytes per segment file */
+	size_t max_segments;            /* Segments kept, oldest deleted first (0=unlimited) */
+	uint32_t index_interval;        /* Records per sparse index block */
+	bool sync_on_roll;              /* Write a full segment back before starting the next */
+};
+
+/* Segment log handle (opaque) */
+struct storage_log;
+
+/* Segment log cursor (opaque) */
+struct storage_log_cursor;
+
+/* Record of one event as stored in a segment, data follows the header */
+struct storage_log_record {
+	uint32_t length;                /* Bytes of event data */
+	uint32_t crc;                   /* CRC32C of the rest of the record */
+	uint64_t timestamp;
+	uint64_t sequence;
+	uint32_t event_type;
+	uint16_t message_type;
+	uint16_t sample_weight;         /* Events it stands for, 0 for 1, at most 65535 */
+	char interface[16];
+};
+
+/* Segment log statistics */
+struct storage_log_stats {
+	uint64_t segments;              /* Segment files, the active one included */
+	uint64_t records;               /* Records in them */
+	uint64_t bytes;                 /* Bytes of records in them */
+	uint64_t appended;              /* Records appended since open */
+	uint64_t failed;                /* Events that could not be appended */
+	uint64_t rolls;                 /* Segments started since open */
+	uint64_t deleted_segments;      /* Segments deleted by retention */
+	uint64_t recovered;             /* Records found in unsealed segments on open */
+};
+
+/**
+ * storage_log_record_data() - Get event data of a record
+ * @record: Record returned by storage_log_cursor_next()
+ *
+ * Returns: Pointer to record->length bytes of event data
+ */
+static inline const void *storage_log_record_data(const struct storage_log_record *record)
+{
+	return record + 1;
+}
+
+/**
+ * storage_log_open() - Open or create segment log
+ * @config: Segment log configuration
+ *
+ * Existing segments are reopened; the newest one continues as the active
+ * segment after recovering its records up to the first one failing its
+ * CRC.
+ *
+ * Returns: Segment log handle or NULL on error
+ */
+struct storage_log *storage_log_open(struct storage_log_config *config);
+
+/**
+ * storage_log_close() - Close segment log
+ * @log: Segment log handle (can be NULL)
+ *
+ * All cursors must have been closed.
+ */
+void storage_log_close(struct storage_log *log);
+
+/**
+ * storage_log_append() - Append event to the log
+ * @log: Segment log handle
+ * @event: Event to append
+ *
+ * Starts a new segment when the active one is full. Safe to call from
+ * several threads.
+ *
+ * Returns: true on success, false on error
+ */
+bool storage_log_append(struct storage_log *log, struct nlmon_event *event);
+
+/**
+ * storage_log_flush() - Write appended records back to the segment file
+ * @log: Segment log handle
+ *
+ * Returns: true on success, false on error
+ */
+bool storage_log_flush(struct storage_log *log);
+
+/**
+ * storage_log_cursor_open() - Open cursor over a time range
+ * @log: Segment log handle
+ * @start_time: First timestamp returned (0=any)
+ * @end_time: Last timestamp returned (0=any)
+ *
+ * Cursors return records in log order, which is timestamp order for
+ * events appended in timestamp order.
+ *
+ * Returns: Cursor handle or NULL on error
+ */
+struct storage_log_cursor *storage_log_cursor_open(struct storage_log *log,
+                                                   uint64_t start_time,
+                                                   uint64_t end_time);
+
+/**
+ * storage_log_segments() - List the segments of a time range
+ * @log: Segment log handle
+ * @start_time: First timestamp wanted (0=any)
+ * @end_time: Last timestamp wanted (0=any)
+ * @ids: Output for segment ids, oldest first
+ * @max: Entries of @ids
+ *
+ * Lists the segments that may hold records of the range, the active one
+ * always, for reading them apart with storage_log_cursor_open_segment().
+ *
+ * Returns: Number of such segments, more than @max if @ids is too short
+ */
+size_t storage_log_segments(struct storage_log *log, uint64_t start_time, uint64_t end_time,
+                            uint64_t *ids, size_t max);
+
+/**
+ * storage_log_cursor_open_segment() - Open cursor over one segment
+ * @log: Segment log handle
+ * @segment_id: Segment, from storage_log_segments()
+ * @start_time: First timestamp returned (0=any)
+ * @end_time: Last timestamp returned (0=any)
+ *
+ * Like storage_log_cursor_open(), but the cursor ends with the segment
+ * instead of moving on to the next. A segment deleted meanwhile gives a
+ * cursor returning no records.
+ *
+ * Returns: Cursor handle or NULL on error
+ */
+struct storage_log_cursor *storage_log_cursor_open_segment(struct storage_log *log,
+                                                           uint64_t segment_id,
+                                                           uint64_t start_time,
+                                                           uint64_t end_time);
+
+/**
+ * storage_log_cursor_next() - Read the next record
+ * @cursor: Cursor handle
+ *
+ * The record is read in place from the segment and stays valid until
+ * the next call on @cursor. A cursor that reached the end returns the
+ * records appended later on its next calls.
+ *
+ * Returns: Record, or NULL if there are no more records
+ */
+const struct storage_log_record *storage_log_cursor_next(struct storage_log_cursor *cursor);
+
+/**
+ * storage_log_cursor_close() - Close cursor
+ * @cursor: Cursor handle (can be NULL)
+ */
+void storage_log_cursor_close(struct storage_log_cursor *cursor);
+
+/**
+ * storage_log_delete_before() - Delete segments before timestamp
+ * @log: Segment log handle
+ * @timestamp: Timestamp threshold
+ *
+ * Deletes the segments whose records are all older than @timestamp,
+ * never the active one. Cursors reading a deleted segment finish it.
+ *
+ * Returns: Number of deleted records, or -1 on error
+ */
+int storage_log_delete_before(struct storage_log *log, uint64_t timestamp);
+
+/**
+ * storage_log_get_stats() - Get segment log statistics
+ * @log: Segment log handle
+ * @stats: Output for statistics
+ *
+ * Returns: true on success, false on error
+ */
+bool storage_log_get_stats(struct storage_log *log, struct storage_log_stats *stats);
+
+#endif /* STORAGE_LOG_H */
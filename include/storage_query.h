@@ -0,0 +1,137 @@
+/* storage_query.h - Parallel scan queries over stored events
+ *
+ * Runs ad-hoc queries over the segment log, or the memory buffer without
+ * one: a filter expression evaluated with the compiled filter VM, then
+ * either the matching events projected to some columns, or their counts
+ * grouped by columns with the timestamp in buckets, largest first and cut
+ * to the top k. Segments are scanned by a pool of worker threads, each
+ * aggregating on its own, and the partial results are merged at the end.
+ *
+ * Counts are by sample weight, see nlmon_event_weight(). A query gives up
+ * when it runs past its timeout or its rows and groups take more memory
+ * than allowed.
+ */
+
+#ifndef STORAGE_QUERY_H
+#define STORAGE_QUERY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Forward declarations */
+struct storage_log;
+struct storage_buffer;
+
+/* Columns a query projects and groups on, as bits of a mask */
+enum query_column {
+	QUERY_COL_TIMESTAMP,
+	QUERY_COL_SEQUENCE,
+	QUERY_COL_EVENT_TYPE,
+	QUERY_COL_MESSAGE_TYPE,
+	QUERY_COL_INTERFACE,
+	QUERY_COLUMNS
+};
+
+#define QUERY_COL_BIT(col) (1u << (col))
+#define QUERY_COL_ALL ((1u << QUERY_COLUMNS) - 1)
+
+/* Defaults for a query field left at 0 */
+#define QUERY_DEFAULT_LIMIT 1000
+#define QUERY_DEFAULT_THREADS 4
+#define QUERY_DEFAULT_TIMEOUT_MS 10000
+#define QUERY_DEFAULT_MAX_MEMORY (64 * 1024 * 1024)
+
+/* Query */
+struct storage_query {
+	const char *filter;             /* Filter expression (NULL=all events) */
+	uint64_t start_time;            /* First timestamp, ns (0=any) */
+	uint64_t end_time;              /* Last timestamp, ns (0=any) */
+	uint32_t columns;               /* Columns projected, QUERY_COL_BIT()s (0=all) */
+	uint32_t group_by;              /* Columns grouped on (0=no grouping, list events) */
+	uint64_t bucket_ns;             /* Width of the timestamp groups (0=exact timestamps) */
+	size_t top_k;                   /* Groups kept, largest count first (0=limit) */
+	size_t limit;                   /* Rows returned at most */
+	unsigned int threads;           /* Worker threads */
+	unsigned int timeout_ms;
+	size_t max_memory;              /* Bytes of rows and groups held at once */
+};
+
+/* Outcome of a query */
+enum storage_query_status {
+	QUERY_OK,
+	QUERY_INVALID,                  /* Bad filter expression or column */
+	QUERY_TIMEOUT,
+	QUERY_MEMORY,                   /* Rows and groups grew past max_memory */
+	QUERY_ERROR,                    /* No storage or no memory */
+};
+
+/* One event, or one group with its key columns set */
+struct query_row {
+	uint64_t timestamp;             /* Of a group, the start of its bucket */
+	uint64_t sequence;
+	uint32_t event_type;
+	uint16_t message_type;
+	char interface[16];             /* NUL terminated */
+	uint64_t count;                 /* Events, by weight */
+};
+
+/* Query result, rows in timestamp order or groups largest first */
+struct storage_query_result {
+	enum storage_query_status status;
+	struct query_row *rows;
+	size_t num_rows;
+	bool truncated;                 /* More rows or groups than returned */
+	uint64_t scanned;               /* Events read */
+	uint64_t matched;               /* Events matching the filter */
+	size_t partitions;              /* Segments, or 1 for the buffer, scanned */
+	uint64_t elapsed_us;
+	char error[256];                /* Why the filter expression is invalid */
+};
+
+/**
+ * storage_query_run() - Run a query
+ * @log: Segment log to scan (can be NULL)
+ * @buffer: Memory buffer, scanned if @log is NULL (can be NULL)
+ * @query: Query
+ * @result: Output, release it with storage_query_result_free()
+ *
+ * Returns: @result->status
+ */
+enum storage_query_status storage_query_run(struct storage_log *log, struct storage_buffer *buffer,
+                                            const struct storage_query *query,
+                                            struct storage_query_result *result);
+
+/**
+ * storage_query_result_free() - Release the rows of a result
+ * @result: Result (can be NULL)
+ */
+void storage_query_result_free(struct storage_query_result *result);
+
+/**
+ * storage_query_parse_columns() - Parse a list of column names
+ * @list: Names separated by commas: timestamp, sequence, event_type,
+ *        message_type, interface
+ * @mask: Output, QUERY_COL_BIT()s of the columns
+ *
+ * Returns: False for an unknown name
+ */
+bool storage_query_parse_columns(const char *list, uint32_t *mask);
+
+/**
+ * storage_query_column_name() - Get the name of a column
+ * @column: Column
+ *
+ * Returns: Name as storage_query_parse_columns() takes it
+ */
+const char *storage_query_column_name(enum query_column column);
+
+/**
+ * storage_query_status_str() - Describe a query status
+ * @status: Status
+ *
+ * Returns: Static string
+ */
+const char *storage_query_status_str(enum storage_query_status status);
+
+#endif /* STORAGE_QUERY_H */
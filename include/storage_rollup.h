@@ -0,0 +1,147 @@
+/* storage_rollup.h - Event counts per series at fixed resolutions
+ *
+ * Keeps the number of events per series, an event type and interface and
+ * optionally the network namespace, at 1 second, 1 minute and 1 hour
+ * resolution. Each resolution is a ring of counters per series holding
+ * the last points of its retention, so adding an event is O(1) and a
+ * query is O(points) whatever the number of events behind them.
+ *
+ * Events count with their sample weight, see nlmon_event_weight(). Time is
+ * the event timestamp, nanoseconds since the epoch. A series table that
+ * fills up counts further series in one overflow series, so memory stays
+ * bounded.
+ *
+ * All functions are safe from any number of threads.
+ */
+
+#ifndef STORAGE_ROLLUP_H
+#define STORAGE_ROLLUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Forward declaration */
+struct nlmon_event;
+
+/* Resolutions kept */
+enum rollup_resolution {
+	ROLLUP_SECOND,
+	ROLLUP_MINUTE,
+	ROLLUP_HOUR,
+	ROLLUP_RESOLUTIONS
+};
+
+/* Defaults for a configuration field left at 0 */
+#define ROLLUP_DEFAULT_SERIES 1024
+#define ROLLUP_DEFAULT_SECONDS 600      /* 10 minutes of 1 second points */
+#define ROLLUP_DEFAULT_MINUTES 1440     /* A day of 1 minute points */
+#define ROLLUP_DEFAULT_HOURS 720        /* 30 days of 1 hour points */
+
+/* Rollup configuration */
+struct storage_rollup_config {
+	bool by_namespace;              /* Series per network namespace as well */
+	size_t max_series;              /* Series before overflow */
+	unsigned int retention[ROLLUP_RESOLUTIONS];  /* Points kept per resolution */
+};
+
+/* What a series counts */
+struct rollup_key {
+	uint32_t event_type;
+	char interface[16];
+	uint64_t netns;                 /* 0 unless by_namespace */
+	bool overflow;                  /* Series beyond max_series, key fields 0 */
+};
+
+/* Points of one series, as a query hands them on */
+struct rollup_series {
+	struct rollup_key key;
+	uint64_t start;                 /* Seconds since the epoch of points[0] */
+	unsigned int step;              /* Seconds per point */
+	size_t num_points;
+	const uint64_t *points;         /* Events per point */
+	uint64_t total;                 /* Sum of the points */
+};
+
+/* Query, series matching every field set */
+struct rollup_query {
+	enum rollup_resolution resolution;
+	uint64_t start;                 /* Seconds since the epoch, 0 for the oldest point kept */
+	uint64_t end;                   /* Exclusive, 0 for after the newest point */
+	bool match_type;
+	uint32_t event_type;
+	const char *interface;          /* NULL for any */
+	bool match_netns;
+	uint64_t netns;
+	bool sum;                       /* Add the matching series up into one */
+};
+
+/* Rollup statistics */
+struct storage_rollup_stats {
+	uint64_t events;                /* Events counted, by weight */
+	uint64_t late;                  /* Events older than a resolution kept, by weight */
+	uint64_t overflow;              /* Events counted in the overflow series, by weight */
+	size_t series;
+	size_t memory;                  /* Bytes of counters */
+	uint64_t newest;                /* Seconds since the epoch of the newest event */
+};
+
+/* Called for each series with points in the range, with the rollup locked */
+typedef void (*rollup_series_fn)(const struct rollup_series *series, void *ctx);
+
+/* Rollup handle (opaque) */
+struct storage_rollup;
+
+/**
+ * storage_rollup_create() - Create a rollup
+ * @config: Configuration, NULL for the defaults
+ *
+ * Returns: Rollup or NULL on error
+ */
+struct storage_rollup *storage_rollup_create(const struct storage_rollup_config *config);
+
+/**
+ * storage_rollup_destroy() - Destroy a rollup
+ * @rollup: Rollup (can be NULL)
+ */
+void storage_rollup_destroy(struct storage_rollup *rollup);
+
+/**
+ * storage_rollup_add() - Count an event
+ * @rollup: Rollup
+ * @event: Event
+ */
+void storage_rollup_add(struct storage_rollup *rollup, const struct nlmon_event *event);
+
+/**
+ * storage_rollup_query() - Hand on the points of the matching series
+ * @rollup: Rollup
+ * @query: Query
+ * @fn: Called for each series with events in the range, not at all for
+ *      a sum without any
+ * @ctx: Context for @fn
+ *
+ * The range is cut to the points the resolution keeps and aligned to its
+ * step. @fn must not call into the rollup.
+ *
+ * Returns: Number of series handed to @fn
+ */
+size_t storage_rollup_query(struct storage_rollup *rollup, const struct rollup_query *query,
+                            rollup_series_fn fn, void *ctx);
+
+/**
+ * storage_rollup_step() - Get the seconds per point of a resolution
+ * @resolution: Resolution
+ *
+ * Returns: Seconds, 0 for an unknown resolution
+ */
+unsigned int storage_rollup_step(enum rollup_resolution resolution);
+
+/**
+ * storage_rollup_get_stats() - Get rollup statistics
+ * @rollup: Rollup
+ * @stats: Output
+ */
+void storage_rollup_get_stats(struct storage_rollup *rollup, struct storage_rollup_stats *stats);
+
+#endif /* STORAGE_ROLLUP_H */
@@ -2,6 +2,11 @@
  *
  * Provides syslog message forwarding with TCP/UDP transport,
  * TLS encryption, and automatic reconnection.
+ *
+ * Messages are sent in batches: one sendmmsg() per batch over UDP, and
+ * RFC 6587 octet-counted frames coalesced into one write over TCP and
+ * TLS. Messages queued while the connection is down are kept, up to the
+ * buffer size, and sent once it is back.
  */
 
 #ifndef SYSLOG_FORWARDER_H
@@ -11,6 +16,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/* Messages queued before a batch is sent */
+#define SYSLOG_BATCH_DEFAULT 32
+
+/* Bytes of messages held while disconnected */
+#define SYSLOG_BUFFER_DEFAULT (256 * 1024)
+
 /* Syslog transport protocol */
 enum syslog_transport {
 	SYSLOG_TRANSPORT_UDP,
@@ -67,6 +78,9 @@ struct syslog_config {
 	const char *tls_ca;           /* TLS CA file (for TLS transport) */
 	bool reconnect;               /* Enable automatic reconnection */
 	uint32_t reconnect_interval;  /* Reconnection interval in seconds */
+	unsigned int batch_size;      /* Most messages per batch (0 for SYSLOG_BATCH_DEFAULT, 1 to send each) */
+	unsigned int batch_latency_ms; /* Batch latency aimed for (0 for 100 ms) */
+	size_t buffer_size;           /* Pending buffer bytes (0 for SYSLOG_BUFFER_DEFAULT) */
 };
 
 /* Syslog forwarder handle (opaque) */
@@ -95,15 +109,32 @@ struct syslog_forwarder *syslog_forwarder_create(struct syslog_config *config);
 void syslog_forwarder_destroy(struct syslog_forwarder *forwarder);
 
 /**
- * syslog_forwarder_send() - Send syslog message
+ * syslog_forwarder_send() - Queue syslog message
  * @forwarder: Syslog forwarder handle
  * @msg: Syslog message to send
  *
- * Returns: true on success, false on error
+ * The message is sent with its batch, once a batch is queued or on
+ * syslog_forwarder_flush(). Batches start at batch_size messages and
+ * shrink while sending them takes longer than batch_latency_ms. Messages that fail to go out
+ * later are counted in the messages_failed statistic.
+ *
+ * Returns: true if queued, false if the buffer is full or on error
  */
 bool syslog_forwarder_send(struct syslog_forwarder *forwarder,
                            struct syslog_message *msg);
 
+/**
+ * syslog_forwarder_flush() - Send queued messages
+ * @forwarder: Syslog forwarder handle
+ *
+ * When disconnected, reconnects first if reconnect is enabled and the
+ * reconnect interval has passed since the last attempt. Messages stay
+ * queued until they are sent.
+ *
+ * Returns: true if nothing is left queued, false otherwise
+ */
+bool syslog_forwarder_flush(struct syslog_forwarder *forwarder);
+
 /**
  * syslog_forwarder_is_connected() - Check if forwarder is connected
  * @forwarder: Syslog forwarder handle
@@ -116,6 +147,8 @@ bool syslog_forwarder_is_connected(struct syslog_forwarder *forwarder);
  * syslog_forwarder_reconnect() - Manually trigger reconnection
  * @forwarder: Syslog forwarder handle
  *
+ * Queued messages are sent on the new connection.
+ *
  * Returns: true on success, false on error
  */
 bool syslog_forwarder_reconnect(struct syslog_forwarder *forwarder);
@@ -0,0 +1,88 @@
+/* thread_affinity.h - CPU pinning, NUMA placement and naming of threads
+ *
+ * CPU sets are given as kernel style CPU lists such as "0-3,8,10-11",
+ * so they can come straight from the configuration file.
+ */
+
+#ifndef THREAD_AFFINITY_H
+#define THREAD_AFFINITY_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+/* Longest thread name the kernel keeps, excluding the terminator */
+#define THREAD_NAME_MAX 15
+
+/* Highest NUMA node a memory policy can name */
+#define THREAD_MAX_NODES 1024
+
+/* Saved NUMA memory policy of a thread */
+struct thread_mempolicy {
+	int mode;
+	unsigned long nodemask[THREAD_MAX_NODES / (8 * sizeof(unsigned long))];
+	bool valid;                     /* Policy was saved and must be restored */
+};
+
+/**
+ * thread_affinity_parse() - Parse a CPU list
+ * @cpus: CPU list, e.g. "0-3,8"
+ * @out: Output for the CPUs in list order, may be NULL if @max is 0
+ * @max: Number of entries in @out
+ *
+ * Returns: Number of CPUs in the list (0 for NULL or ""), at most @max
+ * entries filled, or -1 if the list is malformed
+ */
+int thread_affinity_parse(const char *cpus, int *out, int max);
+
+/**
+ * thread_affinity_valid() - Check a CPU list
+ * @cpus: CPU list, NULL or "" for none
+ *
+ * Returns: true if @cpus is empty or a well-formed CPU list
+ */
+bool thread_affinity_valid(const char *cpus);
+
+/**
+ * thread_affinity_apply() - Pin and name a thread
+ * @thread: Thread
+ * @cpus: CPU list, NULL or "" to leave the thread unpinned
+ * @index: Pin to the @index-th listed CPU (wrapping), or -1 for the whole list
+ * @name: Thread name, truncated to THREAD_NAME_MAX (NULL to keep the name)
+ *
+ * Both are best effort, a thread that cannot be pinned keeps running
+ * where the scheduler puts it.
+ *
+ * Returns: CPU the thread is pinned to, -1 if pinned to the whole list,
+ * unpinned or pinning failed
+ */
+int thread_affinity_apply(pthread_t thread, const char *cpus, int index,
+                          const char *name);
+
+/**
+ * thread_affinity_node() - Get the NUMA node of a CPU list
+ * @cpus: CPU list
+ *
+ * Returns: Node of the first listed CPU, or -1 if unknown or not NUMA
+ */
+int thread_affinity_node(const char *cpus);
+
+/**
+ * thread_affinity_prefer_node() - Prefer a NUMA node for new allocations
+ * @node: Node
+ * @saved: Output for the policy to restore afterwards
+ *
+ * Applies to pages the calling thread faults in from now on, e.g. rings
+ * and pools allocated for threads pinned to @node. Calls nest as long
+ * as each is paired with thread_affinity_restore().
+ *
+ * Returns: 0 on success, negative errno on failure (@saved is then a no-op)
+ */
+int thread_affinity_prefer_node(int node, struct thread_mempolicy *saved);
+
+/**
+ * thread_affinity_restore() - Restore a memory policy
+ * @saved: Policy saved by thread_affinity_prefer_node()
+ */
+void thread_affinity_restore(const struct thread_mempolicy *saved);
+
+#endif /* THREAD_AFFINITY_H */
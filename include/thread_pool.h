@@ -18,6 +18,31 @@ enum work_priority {
 	PRIORITY_MAX = 3
 };
 
+/* Scheduling modes */
+enum thread_pool_mode {
+	THREAD_POOL_SHARED_QUEUE = 0,   /* One priority queue shared by all workers */
+	THREAD_POOL_WORK_STEALING,      /* Per-worker deques, idle workers steal */
+};
+
+/* Elastic sizing defaults */
+#define THREAD_POOL_DEFAULT_WAIT_US 1000
+#define THREAD_POOL_DEFAULT_IDLE_MS 5000
+
+/* Thread pool options */
+struct thread_pool_options {
+	size_t num_threads;             /* Worker threads (0 = auto-detect CPU count) */
+	size_t queue_size;              /* Maximum pending work items (0 = unlimited) */
+	enum thread_pool_mode mode;     /* Scheduling mode */
+	const char *cpus;               /* CPU list workers are pinned to in turn (NULL=any) */
+	const char *name;               /* Worker thread name prefix (NULL="tp-worker") */
+	
+	/* Elastic sizing, shared-queue mode only */
+	size_t min_threads;             /* Fewest workers kept (0 = 1) */
+	size_t max_threads;             /* Most workers started (0 = fixed at num_threads) */
+	unsigned int target_wait_us;    /* Queue wait that starts a worker (0 = default) */
+	unsigned int idle_ms;           /* Idle time before a worker exits (0 = default) */
+};
+
 /* Work function signature */
 typedef void (*work_func_t)(void *arg);
 
@@ -33,6 +58,31 @@ struct thread_pool;
  */
 struct thread_pool *thread_pool_create(size_t num_threads, size_t queue_size);
 
+/**
+ * thread_pool_create_opts() - Create a new thread pool with options
+ * @opts: Thread pool options
+ *
+ * In THREAD_POOL_WORK_STEALING mode work submitted from a worker goes
+ * to that worker's lock-free deque, other work to the least loaded
+ * worker. Idle workers steal before parking. Priorities are honoured
+ * per worker only, there is no global order.
+ *
+ * Workers are named "<name>-<index>". With cpus set, worker i is pinned
+ * to the i-th listed CPU, wrapping around, and the per-worker state is
+ * allocated on the NUMA node of the first listed CPU.
+ *
+ * With max_threads set a THREAD_POOL_SHARED_QUEUE pool is elastic. It
+ * starts num_threads workers, clamped to [min_threads, max_threads].
+ * When a submission finds the oldest queued item older than
+ * target_wait_us and no idle worker for it, one worker is added. A
+ * worker idle for idle_ms exits while more than min_threads run. Two
+ * resizes are at least target_wait_us apart when growing and idle_ms
+ * apart when shrinking, so bursts do not make the pool oscillate.
+ *
+ * Returns: Pointer to thread pool or NULL on error
+ */
+struct thread_pool *thread_pool_create_opts(const struct thread_pool_options *opts);
+
 /**
  * thread_pool_destroy() - Destroy thread pool
  * @pool: Thread pool to destroy
@@ -64,7 +114,7 @@ void thread_pool_wait(struct thread_pool *pool);
  * thread_pool_get_thread_count() - Get number of worker threads
  * @pool: Thread pool
  *
- * Returns: Number of worker threads
+ * Returns: Number of worker threads, currently running ones when elastic
  */
 size_t thread_pool_get_thread_count(struct thread_pool *pool);
 
@@ -88,4 +138,30 @@ void thread_pool_stats(struct thread_pool *pool,
                        unsigned long *completed,
                        unsigned long *rejected);
 
+/**
+ * thread_pool_sched_stats() - Get work-stealing scheduler statistics
+ * @pool: Thread pool
+ * @steals: Output for work items taken from another worker
+ * @parks: Output for the number of times a worker went to sleep
+ *
+ * Both are 0 for pools in THREAD_POOL_SHARED_QUEUE mode.
+ */
+void thread_pool_sched_stats(struct thread_pool *pool,
+                             unsigned long *steals,
+                             unsigned long *parks);
+
+/**
+ * thread_pool_elastic_stats() - Get elastic sizing statistics
+ * @pool: Thread pool
+ * @grown: Output for the number of workers started after creation
+ * @shrunk: Output for the number of workers that exited when idle
+ * @wait_us: Output for the smoothed queue wait of started work items
+ *
+ * All are 0 for pools that are not elastic.
+ */
+void thread_pool_elastic_stats(struct thread_pool *pool,
+                               unsigned long *grown,
+                               unsigned long *shrunk,
+                               unsigned long *wait_us);
+
 #endif /* THREAD_POOL_H */
@@ -5,15 +5,47 @@
 #include "storage_layer.h"
 #include "filter_manager.h"
 #include "nlmon_config.h"
+#include "performance_profiler.h"
+#include "stats_bus.h"
 
-/* API context */
+struct fib_mirror;
+struct neigh_mirror;
+struct ct_mirror;
+
+/* API context, referenced by the registered routes until the server is gone */
 struct web_api_context {
     struct storage_layer *storage;
     struct filter_manager *filter_mgr;
     struct nlmon_config *config;
+    struct nlmon_config_ctx *config_ctx;  /* Versions /api/config snapshots (can be NULL) */
+    unsigned int stats_interval_ms;       /* /api/stats snapshot lifetime, 0 for 1000 */
+    struct performance_profiler *profiler; /* Annotated by /api/debug/profile (can be NULL) */
+    struct stats_bus *stats_bus;          /* Source of /api/stats (can be NULL) */
+    struct fib_mirror *routes;            /* Answers /api/routes, see security_detector_routes() (can be NULL) */
+    struct neigh_mirror *neighbors;       /* Answers /api/neighbors, see security_detector_neighbors() (can be NULL) */
+    struct ct_mirror *flows;              /* Answers /api/conntrack, see security_detector_flows() (can be NULL) */
     void *alert_mgr;  /* Forward declaration */
 };
 
+/* Events listing streamed from storage, for GET /api/events */
+struct api_events_stream;
+
+/* Open an events listing of ?limit (at most max_limit), ?offset, ?cursor
+ * and ?filter arguments, NULL for absent ones. The listing is JSON, or a
+ * CBOR sequence as in event_cbor.h if cbor is set, with its own name
+ * dictionary. NULL on error with the HTTP status and a JSON error body, if
+ * any, in status and error. */
+struct api_events_stream *api_events_open(struct web_api_context *ctx, const char *limit_arg,
+                                          const char *offset_arg, const char *cursor_arg,
+                                          const char *filter_arg, size_t max_limit, bool cbor,
+                                          int *status, char **error);
+
+/* Copy out the next part of the listing, 0 at its end, -1 on error */
+ssize_t api_events_read(struct api_events_stream *es, char *buf, size_t max);
+
+/* Close an events listing */
+void api_events_close(struct api_events_stream *es);
+
 /* Initialize API handlers */
 int web_api_init(struct web_server *server, struct web_api_context *ctx);
 
@@ -2,7 +2,9 @@
 #define WEB_DASHBOARD_H
 
 #include "web_server.h"
+#include "web_api.h"
 #include "websocket_server.h"
+#include "web_stream.h"
 #include "web_auth.h"
 #include "storage_layer.h"
 #include "filter_manager.h"
@@ -18,16 +20,22 @@ struct web_dashboard_config {
     char *static_dir;
     char *auth_secret;
     int enable_auth;
+    char *ws_cpus;      /* CPU list of the WebSocket threads (NULL=any) */
+    enum websocket_compression ws_compression; /* permessage-deflate for clients */
+    int http_threads;   /* HTTP epoll threads, 0 for a thread per connection */
+    int http_per_ip_limit; /* HTTP connections per client address (0=no limit) */
 };
 
 /* Web dashboard context */
 struct web_dashboard {
     struct web_server *http_server;
     struct websocket_server *ws_server;
+    struct web_stream *stream;      /* Filtered WebSocket and SSE subscriptions */
     struct web_auth_context *auth;
     struct storage_layer *storage;
     struct filter_manager *filter_mgr;
     struct nlmon_config *config;
+    struct web_api_context api;     /* Shared by the API routes */
     struct web_dashboard_config dashboard_config;
 };
 
@@ -49,4 +57,10 @@ void web_dashboard_cleanup(struct web_dashboard *dashboard);
 /* Broadcast event to all WebSocket clients */
 int web_dashboard_broadcast_event(struct web_dashboard *dashboard, const char *event_json);
 
+/* Publish event to the WebSocket and SSE clients whose subscription filter
+ * matches, each distinct filter evaluated once. Returns the number of
+ * clients it was sent to or -1 on error. */
+int web_dashboard_publish_event(struct web_dashboard *dashboard, struct nlmon_event *event,
+                                const char *event_json);
+
 #endif /* WEB_DASHBOARD_H */
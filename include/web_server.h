@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/types.h>
 
 /* Web server configuration */
 struct web_server_config {
@@ -12,6 +13,11 @@ struct web_server_config {
     char *key_file;
     char *static_dir;
     int max_connections;
+    int thread_pool_size;       /* Epoll loop threads, 0 for a thread per connection */
+    int per_ip_limit;           /* Connections per client address, 0 for no limit */
+    unsigned int connection_timeout; /* Idle connection timeout in seconds, 0 for none */
+    int max_streams;            /* Concurrent streaming responses, 0 for no limit,
+                                 * or half the thread pool when there is one */
 };
 
 /* Web server context */
@@ -24,15 +30,60 @@ typedef int (*request_handler_t)(void *cls, const char *url, const char *method,
                                   char **response, size_t *response_len,
                                   const char **content_type);
 
+/* Request to a streaming route */
+struct web_request;
+
+/* Get a query string argument of a request, NULL if absent */
+const char *web_request_arg(struct web_request *request, const char *name);
+
+/* Get a header of a request, NULL if absent */
+const char *web_request_header(struct web_request *request, const char *name);
+
+/* Answer a request with another content type than its route's, such as a
+ * negotiated one. The string must outlive the response. */
+void web_request_set_content_type(struct web_request *request, const char *content_type);
+
+/* Streaming route callbacks. The open callback returns the stream, or NULL
+ * with *status and a malloc'd *error body set. The read callback blocks until
+ * it has data and returns its length, or -1 to end the response. The close
+ * callback frees the stream once the response is done. */
+typedef void *(*stream_open_t)(void *user_data, struct web_request *request,
+                               int *status, char **error);
+typedef ssize_t (*stream_read_t)(void *stream, char *buf, size_t max);
+typedef void (*stream_close_t)(void *stream);
+
+/* Cached resource callbacks. The version callback is cheap and called per
+ * request, the build callback runs only when the version has changed and
+ * returns 0 with a malloc'd *body, or -1. */
+typedef uint64_t (*resource_version_t)(void *user_data);
+typedef int (*resource_build_t)(void *user_data, char **body, size_t *len);
+
 /* Initialize web server */
 struct web_server *web_server_init(struct web_server_config *config);
 
-/* Register route handler */
+/* Register route handler. Routes are matched per path segment, a path
+ * ending in '/' also answers the paths below it that have no route of
+ * their own. */
 int web_server_register_route(struct web_server *server, const char *path,
                                const char *method, request_handler_t handler,
                                void *user_data);
 
-/* Start web server */
+/* Register a GET route answered with an endless response, such as
+ * Server-Sent Events */
+int web_server_register_stream(struct web_server *server, const char *path,
+                               const char *content_type, stream_open_t open_fn,
+                               stream_read_t read_fn, stream_close_t close_fn,
+                               void *user_data);
+
+/* Register a GET route answered from a snapshot of its body, rebuilt only
+ * when its version changes. Responses carry an ETag of the body and a
+ * matching If-None-Match is answered with 304 Not Modified. */
+int web_server_register_resource(struct web_server *server, const char *path,
+                                 const char *content_type, resource_version_t version_fn,
+                                 resource_build_t build_fn, void *user_data);
+
+/* Start web server. Files under static_dir are loaded into memory here,
+ * with gzip variants of text files, and served from there with ETags. */
 int web_server_start(struct web_server *server);
 
 /* Stop web server */
@@ -47,8 +98,29 @@ struct web_server_stats {
     uint64_t active_connections;
     uint64_t bytes_sent;
     uint64_t bytes_received;
+    uint64_t not_modified;      /* 304 answers to If-None-Match */
+    uint64_t resource_builds;   /* Cached resource bodies rebuilt */
+    uint64_t active_streams;
+    uint64_t streams_rejected;  /* 503 answers over max_streams */
 };
 
 int web_server_get_stats(struct web_server *server, struct web_server_stats *stats);
 
+/* Latency of one route or cached resource, in microseconds */
+struct web_route_stats {
+    char path[256];
+    char method[16];
+    uint64_t requests;
+    double mean_us;
+    double p50_us;
+    double p90_us;
+    double p99_us;
+    double max_us;
+};
+
+/* Get per-route latency statistics, fills in up to max entries and
+ * returns the number of routes */
+size_t web_server_get_route_stats(struct web_server *server, struct web_route_stats *stats,
+                                  size_t max);
+
 #endif /* WEB_SERVER_H */
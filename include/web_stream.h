@@ -0,0 +1,83 @@
+#ifndef WEB_STREAM_H
+#define WEB_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Filtered event streams for WebSocket and Server-Sent Events clients.
+ *
+ * Every subscriber gives a filter expression. Subscriptions to the same
+ * expression, compared with whitespace outside string literals collapsed,
+ * share one group whose filter is compiled once and evaluated once per
+ * event. The WebSocket members of all matching groups get a single frame
+ * encoded for the event, SSE members get it appended to their queue.
+ *
+ * WebSocket clients that agreed on subprotocol EVENT_CBOR_SUBPROTOCOL get
+ * binary frames in the encoding of event_cbor.h instead, sharing one frame
+ * among them too. Their name dictionary is the stream's: it is sent whole
+ * to a client when it first subscribes, and each new name is sent to every
+ * CBOR client ahead of the event that brought it up.
+ */
+
+struct nlmon_event;
+struct ws_connection;
+
+/* Filtered stream hub */
+struct web_stream;
+
+/* Server-Sent Events subscriber */
+struct web_stream_sse;
+
+/* Stream statistics */
+struct web_stream_stats {
+    size_t groups;              /* Distinct filters */
+    size_t subscribers;
+    uint64_t events;            /* Events published */
+    uint64_t filter_evals;      /* Filter evaluations, at most groups per event */
+    uint64_t deliveries;        /* Events sent to a subscriber */
+    uint64_t sse_dropped;       /* Events an SSE subscriber had no room for */
+};
+
+/* Create stream hub */
+struct web_stream *web_stream_create(void);
+
+/* Destroy stream hub, after the servers feeding it are stopped */
+void web_stream_destroy(struct web_stream *stream);
+
+/* Subscribe a WebSocket connection, replacing its previous subscription.
+ * A NULL or empty expression subscribes to all events. On an invalid
+ * expression the previous subscription stays and error is filled in.
+ * Returns 0 on success, -1 on error. */
+int web_stream_subscribe_ws(struct web_stream *stream, struct ws_connection *conn,
+                            const char *expression, char *error, size_t error_len);
+
+/* Unsubscribe a WebSocket connection, before it is gone */
+void web_stream_unsubscribe_ws(struct web_stream *stream, struct ws_connection *conn);
+
+/* Open an SSE subscriber, NULL with error filled in on failure */
+struct web_stream_sse *web_stream_sse_open(struct web_stream *stream, const char *expression,
+                                           char *error, size_t error_len);
+
+/* Read queued "data:" lines of an SSE subscriber, waiting up to timeout_ms.
+ * Returns bytes read, 0 on timeout, -1 once the stream is shut down. */
+ssize_t web_stream_sse_read(struct web_stream_sse *sse, char *buf, size_t size,
+                            int timeout_ms);
+
+/* Unsubscribe and free an SSE subscriber */
+void web_stream_sse_close(struct web_stream_sse *sse);
+
+/* Publish an event with its JSON message to the subscribers whose filter
+ * matches, encoding it for CBOR subscribers if any match. Returns the
+ * number of subscribers it was sent to. */
+size_t web_stream_publish(struct web_stream *stream, struct nlmon_event *event,
+                          const char *message, size_t len);
+
+/* End all SSE reads, for stopping the HTTP server */
+void web_stream_shutdown(struct web_stream *stream);
+
+/* Get stream statistics */
+void web_stream_get_stats(struct web_stream *stream, struct web_stream_stats *stats);
+
+#endif /* WEB_STREAM_H */
@@ -0,0 +1,98 @@
+/* webhook_sender.h - Asynchronous webhook delivery
+ *
+ * Queues JSON payloads for HTTP POST delivery by one thread running a
+ * curl multi loop, so that submitting never waits for the network.
+ * Each endpoint (URL) reuses its connection with keep-alive, has at most
+ * one request in flight and sends the payloads queued meanwhile as one
+ * JSON array. Failed requests are retried with exponential backoff.
+ */
+
+#ifndef WEBHOOK_SENDER_H
+#define WEBHOOK_SENDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WEBHOOK_MAX_URL 512
+#define WEBHOOK_MAX_ENDPOINTS 16
+
+/* Defaults for zero configuration fields */
+#define WEBHOOK_DEFAULT_QUEUE_SIZE 1024
+#define WEBHOOK_DEFAULT_MAX_BATCH 16
+#define WEBHOOK_DEFAULT_MAX_RETRIES 3
+#define WEBHOOK_DEFAULT_RETRY_MS 500
+#define WEBHOOK_DEFAULT_TIMEOUT_MS 10000
+
+/* Webhook sender configuration, zero fields take the defaults */
+struct webhook_sender_config {
+	size_t queue_size;            /* Payloads queued or in flight, over all endpoints */
+	uint32_t max_batch;           /* Payloads per POST, 1 never batches */
+	uint32_t max_retries;         /* Retries of a failed POST before dropping it */
+	uint32_t retry_base_ms;       /* Delay of the first retry, doubled per retry */
+};
+
+/* Webhook sender handle (opaque) */
+struct webhook_sender;
+
+/* Delivery statistics of one endpoint */
+struct webhook_endpoint_stats {
+	char url[WEBHOOK_MAX_URL];
+	uint64_t delivered;           /* Payloads accepted by the endpoint */
+	uint64_t failed;              /* Payloads given up on */
+	uint64_t dropped;             /* Payloads refused with the queue full */
+	uint64_t requests;            /* POSTs completed, retries included */
+	uint64_t retries;
+	uint64_t latency_avg_us;      /* Mean time of a completed POST */
+	uint64_t latency_max_us;
+	size_t queued;                /* Payloads waiting or in flight */
+};
+
+/**
+ * webhook_sender_create() - Create webhook sender and start its thread
+ * @config: Configuration, NULL for defaults
+ *
+ * libcurl must have been initialized with curl_global_init().
+ *
+ * Returns: Webhook sender handle or NULL on error
+ */
+struct webhook_sender *webhook_sender_create(const struct webhook_sender_config *config);
+
+/**
+ * webhook_sender_destroy() - Destroy webhook sender
+ * @ws: Webhook sender handle (can be NULL)
+ *
+ * Makes one more attempt to deliver what is still queued, without
+ * retries, and waits for it.
+ */
+void webhook_sender_destroy(struct webhook_sender *ws);
+
+/**
+ * webhook_sender_submit() - Queue a payload for delivery
+ * @ws: Webhook sender handle
+ * @url: Endpoint URL
+ * @payload: JSON payload, copied
+ * @timeout_ms: Timeout of the POST, 0 for the default
+ *
+ * Batched payloads are POSTed as a JSON array of them; a POST of a
+ * single payload carries it unchanged. Batches use the timeout of their
+ * first payload.
+ *
+ * Returns: true if queued, false if the queue or endpoint table is full
+ */
+bool webhook_sender_submit(struct webhook_sender *ws, const char *url,
+                           const char *payload, uint32_t timeout_ms);
+
+/**
+ * webhook_sender_get_stats() - Get per-endpoint delivery statistics
+ * @ws: Webhook sender handle
+ * @stats: Output array
+ * @max_stats: Size of @stats
+ *
+ * Returns: Number of endpoints written to @stats
+ */
+size_t webhook_sender_get_stats(struct webhook_sender *ws,
+                                struct webhook_endpoint_stats *stats,
+                                size_t max_stats);
+
+#endif /* WEBHOOK_SENDER_H */
@@ -19,6 +19,21 @@ typedef void (*ws_message_callback_t)(struct ws_connection *conn,
 typedef void (*ws_connect_callback_t)(struct ws_connection *conn, void *user_data);
 typedef void (*ws_disconnect_callback_t)(struct ws_connection *conn, void *user_data);
 
+/* What to do with a client whose write queue is full */
+enum websocket_slow_client {
+    WS_SLOW_CLIENT_DROP,    /* Disconnect it */
+    WS_SLOW_CLIENT_SKIP     /* Skip its oldest queued broadcasts */
+};
+
+/* permessage-deflate (RFC 7692) for clients that offer it */
+enum websocket_compression {
+    WS_COMPRESSION_OFF,     /* Decline the extension */
+    WS_COMPRESSION_CONTEXT, /* Compressor per client kept across messages, best
+                             * ratio, about 300 KB per client */
+    WS_COMPRESSION_SHARED   /* server_no_context_takeover, a broadcast is
+                             * compressed once for all clients */
+};
+
 /* WebSocket server configuration */
 struct websocket_config {
     uint16_t port;
@@ -26,12 +41,39 @@ struct websocket_config {
     ws_connect_callback_t on_connect;
     ws_disconnect_callback_t on_disconnect;
     void *user_data;
+    const char *cpus;   /* CPU list of the server threads (NULL=any) */
+    unsigned int threads; /* Event loop threads (0=1) */
+    enum websocket_slow_client slow_client;
+    enum websocket_compression compression;
+    const char *const *subprotocols; /* Accepted subprotocols, preferred first,
+                                      * NULL terminated (NULL=none). Must stay
+                                      * valid while the server runs. */
+};
+
+/* WebSocket server statistics */
+struct websocket_stats {
+    int connections;
+    uint64_t broadcasts;
+    uint64_t frames_skipped;    /* Broadcasts skipped for lagging clients */
+    uint64_t clients_dropped;   /* Clients disconnected for lagging */
+    uint64_t messages_compressed;
+    uint64_t bytes_uncompressed; /* Payload of the compressed messages */
+    uint64_t bytes_compressed;   /* What went on the wire for them */
+};
+
+/* WebSocket connection statistics */
+struct websocket_connection_stats {
+    int compressed;             /* permessage-deflate negotiated */
+    uint64_t messages_compressed;
+    uint64_t bytes_uncompressed;
+    uint64_t bytes_compressed;
 };
 
 /* Initialize WebSocket server */
 struct websocket_server *websocket_server_init(struct websocket_config *config);
 
-/* Start WebSocket server */
+/* Start WebSocket server, all clients are served by the configured number
+ * of epoll loop threads named "ws-loop" */
 int websocket_server_start(struct websocket_server *server);
 
 /* Stop WebSocket server */
@@ -40,15 +82,40 @@ void websocket_server_stop(struct websocket_server *server);
 /* Cleanup WebSocket server */
 void websocket_server_cleanup(struct websocket_server *server);
 
-/* Send message to connection */
+/* Send message to connection, from any thread. What the socket does not
+ * take right away is queued, a client that falls too far behind is dropped
+ * or skips broadcasts, depending on slow_client.
+ * The connection is valid until its disconnect callback returns. */
 int websocket_send(struct ws_connection *conn, const char *message, size_t len);
 
-/* Broadcast message to all connections */
+/* Broadcast message to all connections. The frame is encoded once and
+ * shared by every client it is queued on. */
 int websocket_broadcast(struct websocket_server *server, const char *message, size_t len);
 
+/* Send one message to a set of connections, encoded once like a
+ * broadcast. The connections must stay valid during the call. */
+int websocket_multicast(struct ws_connection **conns, size_t count,
+                        const char *message, size_t len);
+
+/* Binary variants of websocket_send() and websocket_multicast() */
+int websocket_send_binary(struct ws_connection *conn, const void *data, size_t len);
+int websocket_multicast_binary(struct ws_connection **conns, size_t count,
+                               const void *data, size_t len);
+
+/* Get the subprotocol agreed with the client, one of the configured
+ * subprotocols, or NULL if none */
+const char *websocket_get_subprotocol(struct ws_connection *conn);
+
 /* Get connection count */
 int websocket_get_connection_count(struct websocket_server *server);
 
+/* Get server statistics */
+void websocket_get_stats(struct websocket_server *server, struct websocket_stats *stats);
+
+/* Get connection statistics, 0 on success */
+int websocket_get_connection_stats(struct ws_connection *conn,
+                                   struct websocket_connection_stats *stats);
+
 /* Set connection user data */
 void websocket_set_user_data(struct ws_connection *conn, void *user_data);
 
@@ -0,0 +1,67 @@
+/* window_counter.h - Event counts over a sliding time window
+ *
+ * A ring of per-second buckets with a running total, for detectors that
+ * only need to know how many events fell in the last seconds. Adding,
+ * expiring and counting are O(1) amortized and the memory is fixed when
+ * the counter is created, however many events arrive.
+ *
+ * Counters do not lock, callers serialize access to each counter.
+ */
+
+#ifndef WINDOW_COUNTER_H
+#define WINDOW_COUNTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Most buckets of one counter, longer windows use wider buckets */
+#define WINDOW_COUNTER_MAX_BUCKETS 4096
+
+/* Window counter structure (opaque) */
+struct window_counter;
+
+/**
+ * window_counter_create() - Create a window counter
+ * @window_sec: Window size in seconds
+ *
+ * The window holds events from @window_sec seconds ago up to the newest
+ * second seen, the same events a time window of that size keeps.
+ *
+ * Returns: Pointer to counter or NULL on error
+ */
+struct window_counter *window_counter_create(time_t window_sec);
+
+/**
+ * window_counter_destroy() - Destroy window counter
+ * @wc: Window counter (can be NULL)
+ */
+void window_counter_destroy(struct window_counter *wc);
+
+/**
+ * window_counter_add() - Count events at a time
+ * @wc: Window counter
+ * @timestamp: Time of the events in seconds
+ * @n: Number of events
+ *
+ * A newer @timestamp moves the window on. Events older than the window
+ * are not counted.
+ */
+void window_counter_add(struct window_counter *wc, time_t timestamp, uint32_t n);
+
+/**
+ * window_counter_count() - Get the events in the window at a time
+ * @wc: Window counter
+ * @now: Current time in seconds, moves the window on if newer
+ *
+ * Returns: Number of events in the window
+ */
+uint64_t window_counter_count(struct window_counter *wc, time_t now);
+
+/**
+ * window_counter_reset() - Forget all counted events
+ * @wc: Window counter
+ */
+void window_counter_reset(struct window_counter *wc);
+
+#endif /* WINDOW_COUNTER_H */
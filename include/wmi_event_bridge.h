@@ -33,6 +33,29 @@ struct wmi_event_metadata {
     uint8_t has_stats:1;         /**< Has statistics information */
     uint8_t has_peer:1;          /**< Has peer information */
     uint8_t reserved:6;
+    uint32_t source_id;          /**< Log source, 0 if submitted directly */
+    uint64_t source_seq;         /**< Entry number within its log source */
+};
+
+/* Maximum number of entries converted and submitted as one batch */
+#define WMI_BRIDGE_BATCH_SIZE 64
+
+/* Maximum number of log sources added with wmi_bridge_add_source() */
+#define WMI_BRIDGE_MAX_SOURCES 8
+
+/**
+ * Statistics of a WMI log source
+ */
+struct wmi_bridge_source_stats {
+    uint32_t source_id;          /**< Source ID */
+    const char *log_source;      /**< Log file path or "-", valid until cleanup */
+    int running;                 /**< Source is being read */
+    uint64_t lines_read;         /**< Lines read from the source */
+    uint64_t lines_dropped;      /**< Lines dropped due to buffer overflow */
+    uint64_t bytes_read;         /**< Bytes read from the source */
+    uint64_t entries;            /**< Lines parsed as WMI entries */
+    uint64_t entries_submitted;  /**< Entries accepted by the event processor */
+    uint64_t errors;             /**< Reader errors (I/O, truncation, ...) */
 };
 
 /**
@@ -59,6 +82,9 @@ int wmi_bridge_init(struct wmi_bridge_config *config);
  *
  * Creates an nlmon event from a WMI log entry, populating all relevant
  * fields and metadata. The event can then be submitted to the event processor.
+ * The metadata in event->data is allocated and stays the caller's, as the
+ * processor queues a copy. The display string in event->user_data is
+ * freed by the bridge's event handler.
  *
  * @param wmi_entry Source WMI log entry
  * @param event Target nlmon event structure (must be allocated by caller)
@@ -96,6 +122,20 @@ int wmi_register_event_handler(void);
  */
 int wmi_bridge_submit(const struct wmi_log_entry *wmi_entry);
 
+/**
+ * Submit an array of WMI log entries as events
+ *
+ * Converts the entries in batches of up to WMI_BRIDGE_BATCH_SIZE into
+ * buffers owned by the bridge and submits each batch to the event
+ * processor at once. Nothing is allocated per entry.
+ *
+ * @param wmi_entries WMI log entries to submit
+ * @param count Number of entries
+ * @return Number of entries submitted, negative error code on failure
+ *         -1: Bridge not initialized or invalid parameters
+ */
+int wmi_bridge_submit_batch(const struct wmi_log_entry *wmi_entries, size_t count);
+
 /**
  * Get WMI bridge statistics
  *
@@ -124,18 +164,46 @@ int wmi_bridge_get_stats(uint64_t *events_converted,
  */
 int wmi_bridge_start_monitoring(const char *log_source, int follow_mode);
 
+/**
+ * Add a WMI log source read on a thread of its own
+ *
+ * Any number of sources, such as the logs of each radio of a multi-band
+ * AP, are read concurrently. Events of a source carry its ID and are
+ * numbered in the order read (see struct wmi_event_metadata), so the
+ * order of each source survives the merge into the event processor.
+ * Sources run until wmi_bridge_stop_monitoring() or their end of file.
+ *
+ * @param log_source Log file path or "-" for stdin
+ * @param follow_mode Enable tail -f style following (1=enabled, 0=disabled)
+ * @return Source ID (1 to WMI_BRIDGE_MAX_SOURCES), negative on failure
+ *         -1: Bridge not initialized, invalid parameters or too many sources
+ *         -2: Failed to initialize log reader
+ *         -3: Failed to create reader thread
+ */
+int wmi_bridge_add_source(const char *log_source, int follow_mode);
+
+/**
+ * Get the statistics of a WMI log source
+ *
+ * @param source_id Source ID, 0 for the source of wmi_bridge_start_monitoring()
+ * @param stats Output for the statistics
+ * @return 0 on success, -1 if there is no such source
+ */
+int wmi_bridge_get_source_stats(int source_id, struct wmi_bridge_source_stats *stats);
+
 /**
  * Stop WMI log monitoring
  *
- * Signals the monitoring thread to stop. Safe to call from signal
- * handlers or other threads.
+ * Signals the monitoring thread and the threads of all added sources to
+ * stop. Safe to call from signal handlers or other threads.
  */
 void wmi_bridge_stop_monitoring(void);
 
 /**
  * Cleanup WMI event bridge
  *
- * Stops monitoring, unregisters handlers and frees resources.
+ * Stops monitoring, waits for the source threads, unregisters handlers
+ * and frees resources.
  * Safe to call multiple times.
  */
 void wmi_bridge_cleanup(void);
@@ -4,6 +4,12 @@
  *
  * This module provides functionality to read WMI command logs from files
  * or stdin, parse them line by line, and invoke callbacks for processing.
+ *
+ * Each reader created with wmi_log_reader_create() has its own source,
+ * buffers and statistics, so several sources, such as the logs of the
+ * radios of a multi-band AP, can be read concurrently on threads of
+ * their own. The wmi_log_reader_init() family drives a single default
+ * reader.
  */
 
 #ifndef WMI_LOG_READER_H
@@ -29,6 +35,13 @@ struct wmi_log_config {
      */
     int (*callback)(const char *line, void *user_data);
     
+    /**
+     * Called after each block of lines read, before waiting for more
+     * data (optional). Lets a callback that batches lines hand them on.
+     * @param user_data User-provided context data
+     */
+    void (*flush)(void *user_data);
+    
     void *user_data;             /**< User data passed to callback */
 };
 
@@ -42,6 +55,91 @@ struct wmi_log_stats {
     uint64_t bytes_read;         /**< Total bytes read from source */
 };
 
+/* Reader of one log source (opaque) */
+struct wmi_log_reader;
+
+/**
+ * Create a WMI log reader and open its log source
+ *
+ * @param config Configuration structure with log source and options
+ * @return Reader, NULL on failure
+ */
+struct wmi_log_reader *wmi_log_reader_create(const struct wmi_log_config *config);
+
+/**
+ * Read a WMI log source
+ *
+ * Blocks like wmi_log_reader_start() until the source is exhausted, an
+ * error occurs or wmi_log_reader_interrupt() is called. Readers may run
+ * concurrently on different threads, each reader on one at a time.
+ *
+ * @param reader Reader
+ * @return 0 on normal completion, negative error code on failure
+ */
+int wmi_log_reader_run(struct wmi_log_reader *reader);
+
+/* Results of wmi_log_reader_poll() */
+#define WMI_LOG_POLL_WAIT 0          /**< Read all there is, wait for more */
+#define WMI_LOG_POLL_MORE 1          /**< More is available, poll again soon */
+#define WMI_LOG_POLL_DONE 2          /**< Source exhausted */
+
+/**
+ * Get what to wait on between calls of wmi_log_reader_poll()
+ *
+ * For readers driven from an event loop instead of a thread of their
+ * own: poll once the returned descriptor is readable and, if
+ * *interval_ms is not 0, every *interval_ms as well. A reader of a file
+ * that is not followed has neither and is polled until it is done.
+ *
+ * @param reader Reader
+ * @param interval_ms Output for the polling interval, 0 for none
+ * @return Descriptor to watch for reading, -1 for none
+ */
+int wmi_log_reader_watch(struct wmi_log_reader *reader, int *interval_ms);
+
+/**
+ * Read what a source has without blocking
+ *
+ * Hands at most a bounded number of chunks to the callback per call, so
+ * a long backlog does not hold up the caller's loop. Follows rotations
+ * like wmi_log_reader_run(). Must not be called while the reader runs.
+ *
+ * @param reader Reader
+ * @return WMI_LOG_POLL_WAIT, WMI_LOG_POLL_MORE or WMI_LOG_POLL_DONE,
+ *         negative error code on failure
+ */
+int wmi_log_reader_poll(struct wmi_log_reader *reader);
+
+/**
+ * Stop a running reader
+ *
+ * Safe to call from signal handlers or other threads.
+ *
+ * @param reader Reader
+ */
+void wmi_log_reader_interrupt(struct wmi_log_reader *reader);
+
+/**
+ * Get the statistics of a reader
+ *
+ * May be called from any thread. While the reader runs the statistics
+ * are those as of the last block read.
+ *
+ * @param reader Reader
+ * @param stats Output for reader statistics (optional)
+ * @param error_stats Output for error statistics (optional)
+ * @return 0 on success, -1 if reader is NULL
+ */
+int wmi_log_reader_read_stats(struct wmi_log_reader *reader, struct wmi_log_stats *stats,
+                              struct wmi_error_stats *error_stats);
+
+/**
+ * Destroy a reader, which must not be running
+ *
+ * @param reader Reader (NULL is ignored)
+ */
+void wmi_log_reader_destroy(struct wmi_log_reader *reader);
+
 /**
  * Initialize WMI log reader with configuration
  *
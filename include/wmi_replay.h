@@ -0,0 +1,89 @@
+/**
+ * @file wmi_replay.h
+ * @brief Parallel offline replay of WMI log files
+ *
+ * Replays a complete WMI log file, such as one pulled off a device for
+ * post-mortem analysis, using all cores. The file is mapped and split
+ * into newline-aligned chunks that worker threads parse independently.
+ * The calling thread merges the parsed entries back in timestamp order
+ * and hands them to a sink, by default wmi_bridge_submit().
+ *
+ * Chunks are merged through a window of twice as many chunks as there
+ * are workers, so entries out of order by less than that much of the
+ * file still come out sorted. Entries with equal timestamps keep their
+ * order in the file. An entry without a timestamp sorts with the one
+ * before it in its chunk.
+ */
+
+#ifndef WMI_REPLAY_H
+#define WMI_REPLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "qca_wmi.h"
+
+#define WMI_REPLAY_DEFAULT_CHUNK_SIZE (1024 * 1024)
+#define WMI_REPLAY_DEFAULT_PROGRESS_MS 1000
+
+/**
+ * WMI replay progress, also the final result
+ */
+struct wmi_replay_progress {
+    uint64_t bytes_total;        /**< Size of the log file */
+    uint64_t bytes_parsed;       /**< Bytes of the file parsed so far */
+    uint64_t lines;              /**< Lines parsed */
+    uint64_t entries;            /**< Entries handed to the sink */
+    uint64_t parse_errors;       /**< Lines that were not WMI entries */
+    uint64_t sink_errors;        /**< Entries the sink failed on */
+    double elapsed;              /**< Seconds since the replay started */
+    double bytes_per_sec;        /**< Parse throughput */
+    double entries_per_sec;      /**< Merge throughput */
+};
+
+/**
+ * WMI replay configuration structure
+ */
+struct wmi_replay_config {
+    const char *log_source;      /**< Log file path, not stdin */
+    unsigned int threads;        /**< Parser threads, 0 for one per CPU */
+    size_t chunk_size;           /**< Bytes per chunk, 0 for the default */
+
+    /**
+     * Sink for the entries in timestamp order, called on the thread
+     * running wmi_replay_run(). NULL submits them to the event bridge,
+     * which must be initialized.
+     * @return 0 on success, negative on error
+     */
+    int (*sink)(const struct wmi_log_entry *entry, void *user_data);
+
+    /**
+     * Progress callback, called every progress_ms and once at the end
+     * on the thread running wmi_replay_run() (optional)
+     */
+    void (*progress)(const struct wmi_replay_progress *progress, void *user_data);
+    unsigned int progress_ms;    /**< 0 for the default */
+
+    void *user_data;             /**< User data passed to callbacks */
+};
+
+/**
+ * Replay a WMI log file
+ *
+ * Blocks until the whole file was replayed or wmi_replay_stop() is
+ * called.
+ *
+ * @param config Replay configuration
+ * @param result Final progress (optional)
+ * @return 0 on success, negative error code on failure
+ */
+int wmi_replay_run(const struct wmi_replay_config *config,
+                   struct wmi_replay_progress *result);
+
+/**
+ * Stop a running replay
+ *
+ * Safe to call from signal handlers or other threads.
+ */
+void wmi_replay_stop(void);
+
+#endif /* WMI_REPLAY_H */
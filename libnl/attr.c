@@ -535,6 +535,81 @@ errout:
 	return err;
 }
 
+/**
+ * Create a compact attribute index based on a stream of attributes.
+ * @arg idx		Index to be filled, declared with NLA_INDEX(maxtype).
+ * @arg maxtype		Maximum attribute type expected and accepted.
+ * @arg head		Head of attribute stream.
+ * @arg len		Length of attribute stream.
+ * @arg policy		Attribute validation policy.
+ * @arg trusted		Bitmap of types not to validate, or NULL.
+ *
+ * Does what nla_parse() does without an array of maxtype+1 pointers to
+ * clear: only the presence bitmap is reset, and a type's offset is only
+ * written when it is seen. The policy is applied once the stream has
+ * been walked, to the last occurrence of each present type that is not
+ * in \c trusted and has something to check. Types whose attributes the
+ * caller bounds itself, or that a previous check covered, can be marked
+ * trusted to skip their validation.
+ *
+ * Look attributes up with nla_index_get().
+ *
+ * @return 0 on success or a negative error code.
+ */
+int nla_parse_index(struct nla_index *idx, int maxtype, struct nlattr *head,
+		    int len, const struct nla_policy *policy,
+		    const uint64_t *trusted)
+{
+	uint64_t *present = (uint64_t *) (idx + 1);
+	uint32_t *offset = (uint32_t *) (present + NLA_INDEX_WORDS(maxtype));
+	struct nlattr *nla;
+	int rem, w, err;
+
+	idx->head = head;
+	idx->maxtype = maxtype;
+	idx->count = 0;
+	memset(present, 0, NLA_INDEX_WORDS(maxtype) * sizeof(*present));
+
+	nla_for_each_attr(nla, head, len, rem) {
+		int type = nla_type(nla);
+
+		if (type == 0 || type > maxtype)
+			continue;
+
+		if (!(present[type / 64] & NLA_INDEX_BIT(type))) {
+			present[type / 64] |= NLA_INDEX_BIT(type);
+			idx->count++;
+		}
+		offset[type] = (char *) nla - (char *) head;
+	}
+
+	if (!policy)
+		return 0;
+
+	for (w = 0; w < NLA_INDEX_WORDS(maxtype); w++) {
+		uint64_t pending = present[w];
+
+		if (trusted)
+			pending &= ~trusted[w];
+
+		while (pending) {
+			int type = w * 64 + __builtin_ctzll(pending);
+			const struct nla_policy *pt = &policy[type];
+
+			pending &= pending - 1;
+			if (pt->type == NLA_UNSPEC && !pt->minlen && !pt->maxlen)
+				continue;
+
+			nla = (struct nlattr *) ((char *) head + offset[type]);
+			err = validate_nla(nla, maxtype, policy);
+			if (err < 0)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
 /**
  * Validate a stream of attributes.
  * @arg head		Head of attributes stream.
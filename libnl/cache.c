@@ -122,6 +122,7 @@ void nl_cache_free(struct nl_cache *cache)
 
 	nl_cache_clear(cache);
 	NL_DBG(1, "Freeing cache %p <%s>...\n", cache, nl_cache_name(cache));
+	free(cache->c_hash);
 	free(cache);
 }
 
@@ -132,8 +133,90 @@ void nl_cache_free(struct nl_cache *cache)
  * @{
  */
 
+/** @cond SKIP */
+#define NL_CACHE_HASH_MIN	64
+
+static inline int cache_hashed(struct nl_cache *cache)
+{
+	return cache->c_ops->co_obj_ops && cache->c_ops->co_obj_ops->oo_keygen;
+}
+
+static inline struct nl_object **cache_bucket(struct nl_cache *cache,
+					      struct nl_object *obj)
+{
+	uint32_t key = obj->ce_ops->oo_keygen(obj);
+
+	return &cache->c_hash[key & (cache->c_hash_size - 1)];
+}
+
+/* Double the identity index and rehash the objects in the cache */
+static int cache_hash_grow(struct nl_cache *cache)
+{
+	struct nl_object **old = cache->c_hash, **bucket, *obj;
+	int size = cache->c_hash_size ? cache->c_hash_size * 2 : NL_CACHE_HASH_MIN;
+
+	cache->c_hash = calloc(size, sizeof(*cache->c_hash));
+	if (!cache->c_hash) {
+		cache->c_hash = old;
+		return -NLE_NOMEM;
+	}
+	cache->c_hash_size = size;
+
+	nl_list_for_each_entry(obj, &cache->c_items, ce_list) {
+		bucket = cache_bucket(cache, obj);
+		obj->ce_hnext = *bucket;
+		*bucket = obj;
+	}
+
+	free(old);
+	return 0;
+}
+
+static void cache_hash_del(struct nl_cache *cache, struct nl_object *obj)
+{
+	struct nl_object **bucket;
+
+	for (bucket = cache_bucket(cache, obj); *bucket; bucket = &(*bucket)->ce_hnext) {
+		if (*bucket == obj) {
+			*bucket = obj->ce_hnext;
+			break;
+		}
+	}
+	obj->ce_hnext = NULL;
+}
+
+static int obj_identical(struct nl_object *a, struct nl_object *b)
+{
+	struct nl_object_ops *ops = a->ce_ops;
+	uint32_t req = ops->oo_id_attrs;
+
+	if (ops != b->ce_ops || !ops->oo_compare)
+		return 0;
+
+	if ((a->ce_mask & req) != req || (b->ce_mask & req) != req)
+		return 0;
+
+	return ops->oo_compare(a, b, req, 0) == 0;
+}
+/** @endcond */
+
 static int __cache_add(struct nl_cache *cache, struct nl_object *obj)
 {
+	struct nl_object **bucket;
+
+	if (cache_hashed(cache)) {
+		/* Keep at most one object per bucket on average */
+		if (cache->c_nitems >= cache->c_hash_size &&
+		    cache_hash_grow(cache) < 0 && !cache->c_hash) {
+			nl_object_put(obj);
+			return -NLE_NOMEM;
+		}
+
+		bucket = cache_bucket(cache, obj);
+		obj->ce_hnext = *bucket;
+		*bucket = obj;
+	}
+
 	obj->ce_cache = cache;
 
 	nl_list_add_tail(&obj->ce_list, &cache->c_items);
@@ -189,6 +272,9 @@ void nl_cache_remove(struct nl_object *obj)
 	if (cache == NULL)
 		return;
 
+	if (cache_hashed(cache))
+		cache_hash_del(cache, obj);
+
 	nl_list_del(&obj->ce_list);
 	obj->ce_cache = NULL;
 	nl_object_put(obj);
@@ -198,6 +284,108 @@ void nl_cache_remove(struct nl_object *obj)
 	       obj, cache, nl_cache_name(cache));
 }
 
+/**
+ * Search object in cache
+ * @arg cache		Cache to search in
+ * @arg needle		Object to look for
+ *
+ * Looks for an object with the same identity, the attributes listed
+ * in the object type's oo_id_attrs, as \c needle. Caches of types
+ * providing oo_keygen look in one bucket of their identity index,
+ * others walk all objects.
+ *
+ * @return The object in the cache, without taking a reference, or NULL.
+ */
+struct nl_object *nl_cache_search(struct nl_cache *cache,
+				  struct nl_object *needle)
+{
+	struct nl_object *obj;
+
+	if (cache->c_ops->co_obj_ops != needle->ce_ops)
+		return NULL;
+
+	if (cache_hashed(cache)) {
+		if (!cache->c_hash)
+			return NULL;
+
+		for (obj = *cache_bucket(cache, needle); obj; obj = obj->ce_hnext)
+			if (obj_identical(obj, needle))
+				return obj;
+
+		return NULL;
+	}
+
+	nl_list_for_each_entry(obj, &cache->c_items, ce_list)
+		if (obj_identical(obj, needle))
+			return obj;
+
+	return NULL;
+}
+
+/**
+ * Include an object in a cache
+ * @arg cache		Cache to update
+ * @arg obj		Object parsed from a notification
+ * @arg change_cb	Called for each change made, may be NULL
+ *
+ * Applies the action of the message type the object was parsed from:
+ * NL_ACT_NEW adds it, replacing an object with the same identity
+ * (reported as NL_ACT_CHANGE), NL_ACT_DEL removes the object with its
+ * identity. Other actions leave the cache as is.
+ *
+ * @return 0 or a negative error code.
+ */
+int nl_cache_include(struct nl_cache *cache, struct nl_object *obj,
+		     change_func_t change_cb)
+{
+	struct nl_msgtype *mt;
+	struct nl_object *old;
+	int err;
+
+	if (cache->c_ops->co_obj_ops != obj->ce_ops)
+		return -NLE_OBJ_MISMATCH;
+
+	mt = nl_msgtype_lookup(cache->c_ops, obj->ce_msgtype);
+	if (!mt)
+		return -NLE_MSGTYPE_NOSUPPORT;
+
+	if (mt->mt_act != NL_ACT_NEW && mt->mt_act != NL_ACT_DEL)
+		return 0;
+
+	old = nl_cache_search(cache, obj);
+	if (old) {
+		nl_object_get(old);
+		nl_cache_remove(old);
+		if (mt->mt_act == NL_ACT_DEL && change_cb)
+			change_cb(cache, old, NL_ACT_DEL);
+		nl_object_put(old);
+	}
+
+	if (mt->mt_act == NL_ACT_DEL)
+		return 0;
+
+	err = nl_cache_add(cache, obj);
+	if (err < 0)
+		return err;
+
+	if (change_cb)
+		change_cb(cache, obj, old ? NL_ACT_CHANGE : NL_ACT_NEW);
+
+	return 0;
+}
+
+/**
+ * Mark all objects in a cache
+ * @arg cache		Cache
+ */
+void nl_cache_mark_all(struct nl_cache *cache)
+{
+	struct nl_object *obj;
+
+	nl_list_for_each_entry(obj, &cache->c_items, ce_list)
+		nl_object_mark(obj);
+}
+
 /** @} */
 
 /**
@@ -276,6 +464,18 @@ static int pickup_cb(struct nl_object *c, struct nl_parser_param *p)
 	return nl_cache_add((struct nl_cache *) p->pp_arg, c);
 }
 
+/* Replace the object with the same identity, the new one comes unmarked */
+static int pickup_replace_cb(struct nl_object *c, struct nl_parser_param *p)
+{
+	struct nl_cache *cache = p->pp_arg;
+	struct nl_object *old = nl_cache_search(cache, c);
+
+	if (old)
+		nl_cache_remove(old);
+
+	return nl_cache_add(cache, c);
+}
+
 /**
  * Pickup a netlink dump response and put it into a cache.
  * @arg sk		Netlink socket.
@@ -308,20 +508,17 @@ int nl_cache_pickup(struct nl_sock *sk, struct nl_cache *cache)
 int nl_cache_parse(struct nl_cache_ops *ops, struct sockaddr_nl *who,
 		   struct nlmsghdr *nlh, struct nl_parser_param *params)
 {
-	int i, err;
+	int err;
 
 	if (!nlmsg_valid_hdr(nlh, ops->co_hdrsize))
 		return -NLE_MSG_TOOSHORT;
 
-	for (i = 0; ops->co_msgtypes[i].mt_id >= 0; i++) {
-		if (ops->co_msgtypes[i].mt_id == nlh->nlmsg_type) {
-			err = ops->co_msg_parser(ops, who, nlh, params);
-			if (err != -NLE_OPNOTSUPP)
-				goto errout;
-		}
+	if (nl_msgtype_lookup(ops, nlh->nlmsg_type)) {
+		err = ops->co_msg_parser(ops, who, nlh, params);
+		if (err != -NLE_OPNOTSUPP)
+			goto errout;
 	}
 
-
 	err = -NLE_MSGTYPE_NOSUPPORT;
 errout:
 	return err;
@@ -348,18 +545,67 @@ int nl_cache_parse_and_add(struct nl_cache *cache, struct nl_msg *msg)
 	return nl_cache_parse(cache->c_ops, NULL, nlmsg_hdr(msg), &p);
 }
 
+/** @cond SKIP */
+struct include_xdata {
+	struct nl_cache *cache;
+	change_func_t change_cb;
+};
+
+static int include_cb(struct nl_object *c, struct nl_parser_param *p)
+{
+	struct include_xdata *x = p->pp_arg;
+
+	return nl_cache_include(x->cache, c, x->change_cb);
+}
+/** @endcond */
+
+/**
+ * Parse a netlink message and include it in the cache.
+ * @arg cache		cache to update
+ * @arg msg		netlink message
+ * @arg change_cb	called for each change made, may be NULL
+ *
+ * Like nl_cache_parse_and_add() but applies the message the way
+ * nl_cache_include() does, so notifications update or remove the
+ * object they refer to instead of adding a duplicate.
+ *
+ * @return 0 or a negative error code.
+ */
+int nl_cache_parse_and_include(struct nl_cache *cache, struct nl_msg *msg,
+			       change_func_t change_cb)
+{
+	struct include_xdata x = {
+		.cache = cache,
+		.change_cb = change_cb,
+	};
+	struct nl_parser_param p = {
+		.pp_cb = include_cb,
+		.pp_arg = &x,
+	};
+
+	return nl_cache_parse(cache->c_ops, NULL, nlmsg_hdr(msg), &p);
+}
+
 /**
  * (Re)fill a cache with the contents in the kernel.
  * @arg sk		Netlink socket.
  * @arg cache		cache to update
  *
- * Clears the specified cache and fills it with the current state in
- * the kernel.
+ * Brings the specified cache in line with the current state in the
+ * kernel. Caches of object types providing oo_keygen are updated in
+ * place: each dumped object replaces the one with its identity and
+ * objects the dump did not mention are removed. Others are cleared
+ * and filled from scratch.
  *
  * @return 0 or a negative error code.
  */
 int nl_cache_refill(struct nl_sock *sk, struct nl_cache *cache)
 {
+	struct nl_parser_param p = {
+		.pp_cb = pickup_replace_cb,
+		.pp_arg = cache,
+	};
+	struct nl_object *obj, *tmp;
 	int err;
 
 	err = nl_cache_request_full_dump(sk, cache);
@@ -368,9 +614,23 @@ int nl_cache_refill(struct nl_sock *sk, struct nl_cache *cache)
 
 	NL_DBG(2, "Upading cache %p <%s>, request sent, waiting for dump...\n",
 	       cache, nl_cache_name(cache));
-	nl_cache_clear(cache);
 
-	return nl_cache_pickup(sk, cache);
+	if (!cache_hashed(cache)) {
+		nl_cache_clear(cache);
+		return nl_cache_pickup(sk, cache);
+	}
+
+	nl_cache_mark_all(cache);
+
+	err = __cache_pickup(sk, cache, &p);
+	if (err < 0)
+		return err;
+
+	nl_list_for_each_entry_safe(obj, tmp, &cache->c_items, ce_list)
+		if (obj->ce_flags & NL_OBJ_MARK)
+			nl_cache_remove(obj);
+
+	return 0;
 }
 
 /** @} */
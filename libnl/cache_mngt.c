@@ -22,6 +22,80 @@
 
 static struct nl_cache_ops *cache_ops;
 
+/** @cond SKIP */
+#define NL_MSGTYPE_HASH_SIZE	64
+
+struct nl_msgtype_entry {
+	struct nl_msgtype_entry *	next;
+	struct nl_cache_ops *		ops;
+	struct nl_msgtype *		mt;
+};
+
+/* Message types of all registered operations, by protocol and type */
+static struct nl_msgtype_entry *msgtype_hash[NL_MSGTYPE_HASH_SIZE];
+
+static inline unsigned int msgtype_hashfn(int protocol, int msgtype)
+{
+	return ((unsigned int) protocol * 31 + (unsigned int) msgtype) %
+		NL_MSGTYPE_HASH_SIZE;
+}
+
+static int ops_registered(struct nl_cache_ops *ops)
+{
+	struct nl_cache_ops *t;
+
+	for (t = cache_ops; t; t = t->co_next)
+		if (t == ops)
+			return 1;
+
+	return 0;
+}
+
+static void msgtype_hash_del(struct nl_cache_ops *ops)
+{
+	struct nl_msgtype_entry *e, **ep;
+	int i;
+
+	for (i = 0; ops->co_msgtypes[i].mt_id >= 0; i++) {
+		unsigned int h = msgtype_hashfn(ops->co_protocol,
+						ops->co_msgtypes[i].mt_id);
+
+		for (ep = &msgtype_hash[h]; (e = *ep) != NULL; ) {
+			if (e->ops == ops) {
+				*ep = e->next;
+				free(e);
+			} else
+				ep = &e->next;
+		}
+	}
+}
+
+static int msgtype_hash_add(struct nl_cache_ops *ops)
+{
+	struct nl_msgtype_entry *e;
+	int i;
+
+	for (i = 0; ops->co_msgtypes[i].mt_id >= 0; i++) {
+		unsigned int h = msgtype_hashfn(ops->co_protocol,
+						ops->co_msgtypes[i].mt_id);
+
+		e = calloc(1, sizeof(*e));
+		if (!e) {
+			msgtype_hash_del(ops);
+			return -NLE_NOMEM;
+		}
+
+		/* Latest registration first, as on the ops list */
+		e->ops = ops;
+		e->mt = &ops->co_msgtypes[i];
+		e->next = msgtype_hash[h];
+		msgtype_hash[h] = e;
+	}
+
+	return 0;
+}
+/** @endcond */
+
 /**
  * @name Cache Operations Sets
  * @{
@@ -58,17 +132,41 @@ struct nl_cache_ops *nl_cache_ops_lookup(const char *name)
  */
 struct nl_cache_ops *nl_cache_ops_associate(int protocol, int msgtype)
 {
+	struct nl_msgtype_entry *e;
+
+	for (e = msgtype_hash[msgtype_hashfn(protocol, msgtype)]; e; e = e->next)
+		if (e->ops->co_protocol == protocol && e->mt->mt_id == msgtype)
+			return e->ops;
+
+	return NULL;
+}
+
+/**
+ * Lookup message type of a set of cache operations
+ * @arg ops			cache operations
+ * @arg msgtype			netlink message type
+ *
+ * Registered operations are looked up in the message type table,
+ * others by walking their list of message types.
+ *
+ * @return The message type or NULL if the operations do not
+ *         handle it.
+ */
+struct nl_msgtype *nl_msgtype_lookup(struct nl_cache_ops *ops, int msgtype)
+{
+	struct nl_msgtype_entry *e;
 	int i;
-	struct nl_cache_ops *ops;
 
-	for (ops = cache_ops; ops; ops = ops->co_next) {
-		if (ops->co_protocol != protocol)
-			continue;
+	for (e = msgtype_hash[msgtype_hashfn(ops->co_protocol, msgtype)]; e; e = e->next)
+		if (e->ops == ops && e->mt->mt_id == msgtype)
+			return e->mt;
 
-		for (i = 0; ops->co_msgtypes[i].mt_id >= 0; i++)
-			if (ops->co_msgtypes[i].mt_id == msgtype)
-				return ops;
-	}
+	if (ops_registered(ops))
+		return NULL;
+
+	for (i = 0; ops->co_msgtypes[i].mt_id >= 0; i++)
+		if (ops->co_msgtypes[i].mt_id == msgtype)
+			return &ops->co_msgtypes[i];
 
 	return NULL;
 }
@@ -84,12 +182,18 @@ struct nl_cache_ops *nl_cache_ops_associate(int protocol, int msgtype)
  */
 int nl_cache_mngt_register(struct nl_cache_ops *ops)
 {
+	int err;
+
 	if (!ops->co_name || !ops->co_obj_ops)
 		return -NLE_INVAL;
 
 	if (nl_cache_ops_lookup(ops->co_name))
 		return -NLE_EXIST;
 
+	err = msgtype_hash_add(ops);
+	if (err < 0)
+		return err;
+
 	ops->co_next = cache_ops;
 	cache_ops = ops;
 
@@ -123,6 +227,7 @@ int nl_cache_mngt_unregister(struct nl_cache_ops *ops)
 	NL_DBG(1, "Unregistered cache operations %s\n", ops->co_name);
 
 	*tp = t->co_next;
+	msgtype_hash_del(ops);
 	return 0;
 }
 
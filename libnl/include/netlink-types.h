@@ -25,6 +25,8 @@ struct nl_cache
 	int                     c_iarg1;
 	int                     c_iarg2;
 	struct nl_cache_ops *   c_ops;
+	struct nl_object **	c_hash;
+	int			c_hash_size;
 };
 
 struct nl_cache_assoc
@@ -76,7 +76,48 @@ struct nla_policy {
 	uint16_t	maxlen;
 };
 
+/**
+ * @ingroup attr
+ * Attribute index, see nla_parse_index().
+ *
+ * Only the header; declare storage with NLA_INDEX(). A bitmap records
+ * which types are present and an offset table, read only where the
+ * bitmap says so, locates them, so nothing proportional to the number
+ * of types has to be cleared per message.
+ */
+struct nla_index {
+	/** Attribute stream the offsets are relative to */
+	struct nlattr *	head;
+
+	/** Highest type the storage has room for */
+	int		maxtype;
+
+	/** Distinct types present */
+	int		count;
+} __attribute__((aligned(8)));	/* The bitmap follows directly */
+
+/** Bitmap words covering types 0 to maxtype */
+#define NLA_INDEX_WORDS(maxtype)	((maxtype) / 64 + 1)
+
+/** Bit of an attribute type in its bitmap word */
+#define NLA_INDEX_BIT(type)		(1ULL << ((type) % 64))
+
+/**
+ * Attribute index with room for types up to maxtype
+ *
+ * Pass the \c hdr member to the nla_index functions.
+ */
+#define NLA_INDEX(maxtype)						\
+	struct {							\
+		struct nla_index	hdr;				\
+		uint64_t		present[NLA_INDEX_WORDS(maxtype)]; \
+		uint32_t		offset[(maxtype) + 1];		\
+	}
+
 /* Attribute parsing */
+extern int		nla_parse_index(struct nla_index *, int, struct nlattr *,
+					int, const struct nla_policy *,
+					const uint64_t *);
 extern int		nla_ok(const struct nlattr *, int);
 extern struct nlattr *	nla_next(const struct nlattr *, int *);
 extern int		nla_parse(struct nlattr **, int, struct nlattr *,
@@ -622,6 +663,46 @@ static inline int nla_parse_nested(struct nlattr *tb[], int maxtype, struct nlat
 	return nla_parse(tb, maxtype, (struct nlattr *)nla_data(nla), nla_len(nla), policy);
 }
 
+/**
+ * Look up an attribute in an index
+ * @arg idx		Index filled by nla_parse_index().
+ * @arg type		Attribute type.
+ *
+ * @return Last attribute of the type, or NULL if absent.
+ */
+static inline struct nlattr *nla_index_get(const struct nla_index *idx, int type)
+{
+	const uint64_t *present = (const uint64_t *) (idx + 1);
+	const uint32_t *offset;
+
+	if (type < 0 || type > idx->maxtype ||
+	    !(present[type / 64] & NLA_INDEX_BIT(type)))
+		return NULL;
+
+	offset = (const uint32_t *) (present + NLA_INDEX_WORDS(idx->maxtype));
+	return (struct nlattr *) ((char *) idx->head + offset[type]);
+}
+
+/**
+ * Create attribute index based on nested attribute
+ * @arg idx		Index to be filled.
+ * @arg maxtype		Maximum attribute type expected and accepted.
+ * @arg nla		Nested Attribute.
+ * @arg policy		Attribute validation policy.
+ * @arg trusted		Bitmap of types not to validate, or NULL.
+ *
+ * @see nla_parse_index
+ * @return 0 on success or a negative error code.
+ */
+static inline int nla_parse_nested_index(struct nla_index *idx, int maxtype,
+					 struct nlattr *nla,
+					 const struct nla_policy *policy,
+					 const uint64_t *trusted)
+{
+	return nla_parse_index(idx, maxtype, (struct nlattr *)nla_data(nla),
+			       nla_len(nla), policy, trusted);
+}
+
 /**
  * Compare attribute payload with memory area.
  * @arg nla		Attribute.
@@ -52,6 +52,9 @@ extern int			nl_cache_add(struct nl_cache *,
 					     struct nl_object *);
 extern int			nl_cache_parse_and_add(struct nl_cache *,
 						       struct nl_msg *);
+extern int			nl_cache_parse_and_include(struct nl_cache *,
+							   struct nl_msg *,
+							   change_func_t);
 extern void			nl_cache_remove(struct nl_object *);
 extern int			nl_cache_refill(struct nl_sock *,
 						struct nl_cache *);
@@ -65,6 +68,8 @@ extern int			nl_cache_include(struct nl_cache *,
 						 change_func_t);
 
 /* General */
+extern struct nl_object *	nl_cache_search(struct nl_cache *,
+						struct nl_object *);
 extern int			nl_cache_is_empty(struct nl_cache *);
 extern void			nl_cache_mark_all(struct nl_cache *);
 
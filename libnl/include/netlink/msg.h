@@ -25,6 +25,7 @@ extern "C" {
 #endif
 
 struct nla_policy;
+struct nla_index;
 
 #define NL_DONTPAD	0
 
@@ -71,6 +72,9 @@ extern int		  nlmsg_parse(struct nlmsghdr *, int, struct nlattr **,
 				      int, const struct nla_policy *);
 extern int		  nlmsg_validate(const struct nlmsghdr *, int, int,
 					 const struct nla_policy *);
+extern int		  nlmsg_parse_index(struct nlmsghdr *, int, struct nla_index *,
+					    int, const struct nla_policy *,
+					    const uint64_t *);
 
 extern struct nl_msg *	  nlmsg_alloc(void);
 extern struct nl_msg *	  nlmsg_alloc_size(size_t);
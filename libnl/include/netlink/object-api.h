@@ -188,7 +188,8 @@ extern "C" {
 	struct nl_list_head	ce_list;	\
 	int			ce_msgtype;	\
 	int			ce_flags;	\
-	uint32_t		ce_mask;
+	uint32_t		ce_mask;	\
+	struct nl_object *	ce_hnext;
 
 /**
  * Return true if attribute is available in both objects
@@ -320,6 +321,17 @@ struct nl_object_ops
 
 
 	char *(*oo_attrs2str)(int, char *, size_t);
+
+	/**
+	 * Hash key generator
+	 *
+	 * Will be called to hash the attributes listed in oo_id_attrs.
+	 * Objects oo_compare() considers identical must hash to the
+	 * same key. Caches of object types providing it index their
+	 * objects by this key so nl_cache_search() does not have to
+	 * walk the whole cache.
+	 */
+	uint32_t (*oo_keygen)(struct nl_object *);
 };
 
 /** @} */
@@ -12,6 +12,7 @@
 #ifndef NETLINK_SOCKET_H_
 #define NETLINK_SOCKET_H_
 
+#include <string.h>
 #include <netlink/types.h>
 #include <netlink/handlers.h>
 
@@ -29,6 +30,22 @@ struct nl_cb;
 struct nl_msg;
 
 typedef void (*nl_debug_cb)(void *priv, struct nl_msg *msg);
+
+/**
+ * Receive buffer allocator
+ *
+ * See nl_socket_set_buf_pool(). realloc() need not keep the contents
+ * of the buffer when old_size is 0.
+ */
+struct nl_buf_pool
+{
+	void *			(*alloc)(void *priv, size_t size);
+	void *			(*realloc)(void *priv, void *buf, size_t old_size,
+					   size_t new_size);
+	void			(*free)(void *priv, void *buf);
+	void *			priv;
+};
+
 struct nl_sock
 {
 	struct sockaddr_nl	s_local;
@@ -44,6 +61,8 @@ struct nl_sock
 	nl_debug_cb		s_debug_rx_cb;
 	void *			s_debug_tx_priv;
 	void *			s_debug_rx_priv;
+
+	struct nl_buf_pool	s_buf_pool;
 };
 
 
@@ -76,6 +95,27 @@ static inline void nl_socket_set_rx_debug_cb(struct nl_sock *sk, nl_debug_cb cb,
 	sk->s_debug_rx_priv = priv;
 }
 
+/**
+ * Receive into pooled buffers
+ * @arg sk		Netlink socket.
+ * @arg pool		Buffer allocator, copied, or NULL for the default.
+ *
+ * nl_recvmsgs() then takes its receive buffer from \c pool and hands
+ * the callbacks one nl_msg that points into that buffer and is reused
+ * for every message, so a steady stream is received without touching
+ * the heap. Callbacks must not keep the message or take a reference to
+ * it; nlmsg_convert() makes a copy that may be kept. A receive
+ * function set with nl_cb_overwrite_recv() disables the pool.
+ */
+static inline void nl_socket_set_buf_pool(struct nl_sock *sk,
+					  const struct nl_buf_pool *pool)
+{
+	if (pool)
+		sk->s_buf_pool = *pool;
+	else
+		memset(&sk->s_buf_pool, 0, sizeof(sk->s_buf_pool));
+}
+
 /**
  * Use next sequence number
  * @arg sk		Netlink socket.
@@ -231,6 +231,28 @@ int nlmsg_parse(struct nlmsghdr *nlh, int hdrlen, struct nlattr *tb[],
 			 nlmsg_attrlen(nlh, hdrlen), policy);
 }
 
+/**
+ * nlmsg_parse_index - index attributes of a netlink message
+ * @arg nlh		netlink message header
+ * @arg hdrlen		length of family specific header
+ * @arg idx		attribute index to be filled
+ * @arg maxtype		maximum attribute type to be expected
+ * @arg policy		validation policy
+ * @arg trusted		bitmap of types not to validate, or NULL
+ *
+ * See nla_parse_index()
+ */
+int nlmsg_parse_index(struct nlmsghdr *nlh, int hdrlen, struct nla_index *idx,
+		      int maxtype, const struct nla_policy *policy,
+		      const uint64_t *trusted)
+{
+	if (!nlmsg_valid_hdr(nlh, hdrlen))
+		return -NLE_MSG_TOOSHORT;
+
+	return nla_parse_index(idx, maxtype, nlmsg_attrdata(nlh, hdrlen),
+			       nlmsg_attrlen(nlh, hdrlen), policy, trusted);
+}
+
 /**
  * nlmsg_validate - validate a netlink message including attributes
  * @arg nlh		netlinket message header
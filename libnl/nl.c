@@ -160,6 +160,45 @@ errout:
 	return err;
 }
 
+/**
+ * Use an already connected netlink socket.
+ * @arg sk		Netlink socket, not connected.
+ * @arg protocol	Netlink protocol of the socket.
+ * @arg fd		Bound netlink socket, such as one inherited or received
+ *			from another process.
+ *
+ * The socket keeps its port and multicast memberships. On success @fd
+ * belongs to @sk and is closed by nl_close(), on failure it is left open.
+ *
+ * @return 0 on success or a negative error code.
+ */
+int nl_connect_fd(struct nl_sock *sk, int protocol, int fd)
+{
+	socklen_t addrlen;
+	int proto;
+
+	addrlen = sizeof(proto);
+	if (getsockopt(fd, SOL_SOCKET, SO_PROTOCOL, &proto, &addrlen) < 0)
+		return -nl_syserr2nlerr(errno);
+	if (proto != protocol)
+		return -NLE_PROTO_MISMATCH;
+
+	addrlen = sizeof(sk->s_local);
+	if (getsockname(fd, (struct sockaddr *) &sk->s_local, &addrlen) < 0)
+		return -nl_syserr2nlerr(errno);
+
+	if (addrlen != sizeof(sk->s_local))
+		return -NLE_NOADDR;
+
+	if (sk->s_local.nl_family != AF_NETLINK)
+		return -NLE_AF_NOSUPPORT;
+
+	sk->s_fd = fd;
+	sk->s_proto = protocol;
+
+	return 0;
+}
+
 /**
  * Close/Disconnect netlink socket.
  * @arg sk		Netlink socket.
@@ -481,6 +520,138 @@ abort:
 	return 0;
 }
 
+/*
+ * nl_recv() for a socket with a buffer pool. The buffer comes from the
+ * pool, credentials are copied to @creds and control data stays on the
+ * stack, so nothing is allocated once the pool is warm.
+ */
+static int nl_recv_pooled(struct nl_sock *sk, struct sockaddr_nl *nla,
+			  unsigned char **buf, struct ucred *creds,
+			  int *have_creds)
+{
+	struct nl_buf_pool *pool = &sk->s_buf_pool;
+	union {
+		char buf[CMSG_SPACE(sizeof(struct ucred)) + 64];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov;
+	struct msghdr msg = {
+		.msg_name = (void *) nla,
+		.msg_namelen = sizeof(struct sockaddr_nl),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = NULL,
+		.msg_controllen = 0,
+		.msg_flags = 0,
+	};
+	struct cmsghdr *cmsg;
+	unsigned char *grown;
+	int flags = 0;
+	int n, err;
+
+	*have_creds = 0;
+	if (sk->s_flags & NL_MSG_PEEK)
+		flags |= MSG_PEEK;
+
+	iov.iov_len = getpagesize() * 4;
+	iov.iov_base = *buf = pool->alloc(pool->priv, iov.iov_len);
+	if (!*buf)
+		return -NLE_NOMEM;
+
+retry:
+	if (sk->s_flags & NL_SOCK_PASSCRED) {
+		msg.msg_control = &control;
+		msg.msg_controllen = sizeof(control);
+	}
+
+	n = recvmsg(sk->s_fd, &msg, flags);
+	if (!n)
+		goto abort;
+	else if (n < 0) {
+		if (errno == EINTR) {
+			NL_DBG(3, "recvmsg() returned EINTR, retrying\n");
+			goto retry;
+		} else if (errno == EAGAIN) {
+			NL_DBG(3, "recvmsg() returned EAGAIN, aborting\n");
+			goto abort;
+		}
+		err = -nl_syserr2nlerr(errno);
+		pool->free(pool->priv, *buf);
+		*buf = NULL;
+		return err;
+	}
+
+	if (iov.iov_len < (size_t) n ||
+	    msg.msg_flags & MSG_TRUNC) {
+		/* The contents are read again */
+		grown = pool->realloc(pool->priv, *buf, 0, iov.iov_len * 2);
+		if (!grown) {
+			pool->free(pool->priv, *buf);
+			*buf = NULL;
+			return -NLE_NOMEM;
+		}
+		iov.iov_len *= 2;
+		iov.iov_base = *buf = grown;
+		goto retry;
+	} else if (flags != 0) {
+		/* Buffer is big enough, do the actual reading */
+		flags = 0;
+		goto retry;
+	}
+
+	if (msg.msg_namelen != sizeof(struct sockaddr_nl)) {
+		pool->free(pool->priv, *buf);
+		*buf = NULL;
+		return -NLE_NOADDR;
+	}
+
+	if (msg.msg_controllen) {
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET &&
+			    cmsg->cmsg_type == SCM_CREDENTIALS) {
+				memcpy(creds, CMSG_DATA(cmsg), sizeof(*creds));
+				*have_creds = 1;
+				break;
+			}
+		}
+	}
+
+	return n;
+
+abort:
+	pool->free(pool->priv, *buf);
+	*buf = NULL;
+	return 0;
+}
+
+/* Point the reused message of a pooled receive at @hdr */
+static struct nl_msg *recvmsgs_wrap(struct nl_msg *msg, struct nlmsghdr *hdr)
+{
+	memset(msg, 0, sizeof(*msg));
+	msg->nm_refcnt = 1;
+	msg->nm_protocol = -1;
+	msg->nm_nlh = hdr;
+	msg->nm_size = NLMSG_ALIGN(hdr->nlmsg_len);
+
+	return msg;
+}
+
+/* Release what one read of recvmsgs() holds */
+static void recvmsgs_release(struct nl_sock *sk, int pooled, struct nl_msg *msg,
+			     unsigned char *buf, struct ucred *creds)
+{
+	if (pooled) {
+		if (buf)
+			sk->s_buf_pool.free(sk->s_buf_pool.priv, buf);
+		return;
+	}
+
+	nlmsg_free(msg);
+	free(buf);
+	free(creds);
+}
+
 #define NL_CB_CALL(cb, type, msg) \
 do { \
 	err = nl_cb_call(cb, type, msg); \
@@ -499,18 +670,24 @@ do { \
 
 static int recvmsgs(struct nl_sock *sk, struct nl_cb *cb)
 {
-	int n, err = 0, multipart = 0;
+	int n, err = 0, multipart = 0, have_creds;
+	int pooled = !cb->cb_recv_ow && sk->s_buf_pool.alloc;
 	unsigned char *buf = NULL;
 	struct nlmsghdr *hdr;
 	struct sockaddr_nl nla = {0};
 	struct nl_msg *msg = NULL;
+	struct nl_msg rx_msg;
 	struct ucred *creds = NULL;
+	struct ucred rx_creds;
 
 continue_reading:
 	NL_DBG(3, "Attempting to read from %p\n", sk);
 	if (cb->cb_recv_ow)
 		n = cb->cb_recv_ow(sk, &nla, &buf, &creds);
-	else
+	else if (pooled) {
+		n = nl_recv_pooled(sk, &nla, &buf, &rx_creds, &have_creds);
+		creds = have_creds ? &rx_creds : NULL;
+	} else
 		n = nl_recv(sk, &nla, &buf, &creds);
 
 	if (n <= 0)
@@ -525,11 +702,15 @@ continue_reading:
 	while (nlmsg_ok(hdr, n)) {
 		NL_DBG(3, "recgmsgs(%p): Processing valid message...\n", sk);
 
-		nlmsg_free(msg);
-		msg = nlmsg_convert(hdr);
-		if (!msg) {
-			err = -NLE_NOMEM;
-			goto out;
+		if (pooled)
+			msg = recvmsgs_wrap(&rx_msg, hdr);
+		else {
+			nlmsg_free(msg);
+			msg = nlmsg_convert(hdr);
+			if (!msg) {
+				err = -NLE_NOMEM;
+				goto out;
+			}
 		}
 
 		nlmsg_set_proto(msg, sk->s_proto);
@@ -661,9 +842,7 @@ skip:
 		hdr = nlmsg_next(hdr, &n);
 	}
 	
-	nlmsg_free(msg);
-	free(buf);
-	free(creds);
+	recvmsgs_release(sk, pooled, msg, buf, creds);
 	buf = NULL;
 	msg = NULL;
 	creds = NULL;
@@ -675,9 +854,7 @@ skip:
 stop:
 	err = 0;
 out:
-	nlmsg_free(msg);
-	free(buf);
-	free(creds);
+	recvmsgs_release(sk, pooled, msg, buf, creds);
 
 	return err;
 }
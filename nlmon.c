@@ -24,6 +24,10 @@
  * THE SOFTWARE.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <assert.h>
 #include <ctype.h>
 #include <err.h>
@@ -34,13 +38,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#ifdef ENABLE_CLI
 #include <ncurses.h>
+#endif
 #include <pthread.h>
+#include <stdatomic.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <arpa/inet.h>
 
 /* <linux/if.h>/<net/if.h> can NOT co-exist! */
@@ -64,6 +73,7 @@
 #include <netlink/route/rule.h>
 #endif
 #include <linux/netlink.h>
+#include <linux/genetlink.h>
 
 /* Memory management and resource tracking */
 #include "memory_tracker.h"
@@ -71,10 +81,33 @@
 #include "signal_handler.h"
 #include "netlink_multi_protocol.h"
 #include "nlmon_netlink.h"
+#include "io_recv.h"
+#include "nlmon_nl_limits.h"
+#include "nlmon_nl_event.h"
+#include "event_processor.h"
+#include "stats_bus.h"
+#include "memory_governor.h"
+#include "pipeline_watchdog.h"
+#include "adaptive_batch.h"
+#include "huge_alloc.h"
+#include "filter_manager.h"
+#include "cli_control.h"
+#include "nlmon_clock.h"
+#include "log_ring.h"
+#include "hot_upgrade.h"
+#include "filter_parser.h"
+#include "filter_compiler.h"
+#include "filter_eval.h"
 #include "nlmon_nl_route.h"
 #include "nlmon_nl_genl.h"
 #include "nlmon_nl_diag.h"
 #include "nlmon_nl_netfilter.h"
+#include "nlmon_nl_optimize.h"
+#include "nlmon_nl_netns.h"
+#include "namespace_tracker.h"
+#include "startup_graph.h"
+#include "nlmon_config.h"
+#include "thread_affinity.h"
 
 /* Forward declarations for nlmon netlink manager (avoid header conflicts) */
 struct nlmon_nl_manager;
@@ -93,24 +126,31 @@ int nlmon_nl_process_genl(struct nlmon_nl_manager *mgr);
 int nlmon_nl_process_diag(struct nlmon_nl_manager *mgr);
 int nlmon_nl_process_nf(struct nlmon_nl_manager *mgr);
 
+#ifdef ENABLE_QCA
 /* WMI monitoring support */
 #include "wmi_log_reader.h"
 #include "wmi_event_bridge.h"
+#include "wmi_replay.h"
 
 /* QCA driver control integration */
 #include "qca_nlmon_integration.h"
+#endif
 
-/* CLI mode globals */
+/* CLI mode globals, the event log is also handed over on upgrades */
 static int cli_mode = 0;
+#ifdef ENABLE_CLI
 static WINDOW *main_win = NULL;
 static WINDOW *status_win = NULL;
 static WINDOW *cmd_win = NULL;
+#endif
 static pthread_mutex_t screen_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 #define MAX_EVENTS 1000
 static char event_log[MAX_EVENTS][256];
 static int event_count = 0;
+#ifdef ENABLE_CLI
 static int event_scroll = 0;
+#endif
 
 /* Statistics */
 struct stats {
@@ -132,6 +172,90 @@ static struct signal_handler *g_signal_handler = NULL;
 static struct nlmon_multi_protocol_ctx *g_multi_proto_ctx = NULL;
 static struct nlmon_nl_manager *g_nl_manager = NULL;
 
+/* Subsystem startup, kept until exit for the phases started lazily */
+#define STARTUP_THREADS 4
+static struct startup_graph *g_startup = NULL;
+
+/* Phases of main, each timed from the end of the one before, reported
+ * with -Z <reloads> before timing that many reloads and exiting */
+#define STARTUP_MAX_MARKS 16
+static struct {
+	const char *name;
+	uint64_t start_ns;
+	uint64_t duration_ns;
+} g_startup_marks[STARTUP_MAX_MARKS];
+static int g_startup_mark_count;
+static uint64_t g_startup_begin_ns;
+static uint64_t g_startup_last_ns;
+static int g_subsystems_mark = -1;
+static int startup_report_reloads = -1;
+#ifdef ENABLE_QCA
+static int g_qca_phase = -1;
+static atomic_bool g_qca_ready;
+#endif
+
+/* Per-protocol netlink receive threads (-T) */
+static int use_rx_threads = 0;
+static int rx_threads_cpu = -1;
+static struct event_processor *g_rx_processor = NULL;
+
+/* io_uring multishot receive (-U) */
+static int use_rx_uring = 0;
+static struct io_recv *g_rx_recv = NULL;
+
+/* Socket buffer accounting for netlink overrun recovery */
+static struct nlmon_nl_limits *g_nl_limits = NULL;
+
+/* Pipeline statistics, one snapshot per second */
+static struct stats_bus *g_stats_bus = NULL;
+
+/*
+ * Embedded mode (-E, default when built with EMBEDDED=1): everything runs
+ * on the main loop for devices with a core or two and little memory.
+ * Startup runs its phases one after the other, the stats bus publishes
+ * from a timer, the log is written as it is logged and no clock ticker
+ * runs, so an idle monitor only wakes up for its timers.
+ */
+#ifdef NLMON_EMBEDDED
+static int embedded_mode = 1;
+#else
+static int embedded_mode = 0;
+#endif
+
+/* Seconds between the RSS and wakeup reports of embedded mode */
+#define EMBEDDED_REPORT_INTERVAL 60
+
+/* Loop wakeups by timers, the ones an idle monitor still has */
+static unsigned long g_timer_wakeups;
+
+/* Loop time of the last embedded mode report, or of the loop's start */
+static ev_tstamp g_report_time;
+
+#ifdef ENABLE_CONFIG
+/* Pipeline watchdog settings (core.stall_ms), scanned from a timer in
+ * embedded mode */
+static struct nlmon_watchdog_config g_watchdog_config;
+#endif
+
+/* Memory budget of the process (core.memory_budget), checked per snapshot */
+static struct memory_governor *g_memory_governor = NULL;
+
+/* Zero-downtime upgrade (-H): what the predecessor handed over, kept until
+ * startup confirms it, and the socket a successor connects to */
+static char *upgrade_path = NULL;
+static struct nlmon_upgrade *g_upgrade = NULL;
+static int g_upgrade_conn = -1;
+static int upgrade_listen_fd = -1;
+static int upgrade_handed_over = 0;
+static int rx_recv_nlmon_source = -1;
+
+/* Control socket (-K) for nlmon_ctl and remote CLIs, with the named
+ * filters its clients manage and subscribe with */
+static char *control_path = NULL;
+static struct cli_control_server *g_control = NULL;
+static struct filter_manager *g_control_filters = NULL;
+static pthread_mutex_t control_lock = PTHREAD_MUTEX_INITIALIZER;
+
 struct context {
 	/* Legacy fields - kept for compatibility but may be unused */
 	struct nl_sock        *ns;
@@ -154,16 +278,43 @@ static int verbose_mode = 0;
 static int debug_netlink = 0;  /* Debug mode for netlink messages */
 static int nlmon_sock = -1;
 static int filter_msg_type = -1;  /* -1 means no filter */
+static char *filter_expression = NULL;  /* -f given as a filter expression */
+static struct filter_expr *g_filter_expr = NULL;  /* Parsed -f filter */
+static struct filter_bytecode *g_filter_bc = NULL;  /* Expression form only */
+static struct filter_eval_context *g_filter_pkt_ctx = NULL;
+static struct filter_eval_context *g_filter_nl_ctx = NULL;
 static int show_generic_netlink = 0;
 static int show_all_protocols = 0;
 
-/* WMI monitoring options */
+/* -N: the same protocols in every network namespace, one epoll set */
+#define NETNS_SYNC_INTERVAL 10.0
+
+static int monitor_all_netns = 0;
+static struct nlmon_nl_netns_set *g_netns_set = NULL;
+static struct namespace_tracker *g_ns_tracker = NULL;
+
+#ifdef ENABLE_QCA
+/* WMI monitoring options, one source per -w (e.g. per radio) */
+#define WMI_MAX_SOURCES 8
+
+struct wmi_source {
+	char *path;
+	int follow_mode;
+	struct wmi_log_reader *reader;  /* NULL when replayed */
+	pthread_t thread;
+	int thread_started;
+	
+	/* Embedded mode reads from the loop instead of the thread */
+	ev_io io;
+	ev_timer timer;
+	ev_idle idle;
+};
+
 static int enable_wmi = 0;
-static char *wmi_source = NULL;
-static int wmi_follow_mode = 0;
+static struct wmi_source wmi_sources[WMI_MAX_SOURCES];
+static int wmi_source_count = 0;
+static int wmi_replay_mode = 0;
 static char *wmi_filter_expr = NULL;
-static pthread_t wmi_thread;
-static int wmi_thread_started = 0;
 
 /* QCA driver control options */
 static int enable_qca_control = 0;
@@ -171,7 +322,76 @@ static char *qca_interface = NULL;
 static int qca_auto_roaming = 0;
 static int qca_stats_on_roam = 0;
 
+/* Link stats polling (-L secs[,iface...]) */
+#define QCA_POLL_JITTER_PCT 10
+static char *qca_poll_spec = NULL;
+static struct qca_stats_poller *g_stats_poller = NULL;
+static ev_timer qca_poll_timer;
+#endif
+
 #define MAX_NETLINK_PACKET_SIZE 65536
+#define NLMON_RX_BATCH_MAX 64
+
+/* Batched receive state for the nlmon packet socket (see -b) */
+static unsigned int nlmon_rx_batch = 1;
+static unsigned char *rx_bufs = NULL;
+static struct iovec *rx_iov = NULL;
+static struct mmsghdr *rx_msgs = NULL;
+static struct sockaddr_ll *rx_addrs = NULL;
+
+/* Receive statistics for the nlmon packet socket */
+struct nlmon_rx_stats {
+	unsigned long wakeups;       /* Readiness callbacks */
+	unsigned long batches;       /* recvmmsg() calls returning data */
+	unsigned long full_batches;  /* Batches that filled every slot */
+	unsigned long packets;       /* Datagrams received */
+	unsigned long messages;      /* Netlink messages parsed */
+	unsigned long truncated;     /* Datagrams larger than a slot */
+	unsigned long ring_drops;    /* Frames dropped by the kernel (mmap ring) */
+	unsigned long ring_freezes;  /* Ring queue freezes (mmap ring) */
+	unsigned int max_batch;      /* Largest batch seen */
+};
+
+static struct nlmon_rx_stats rx_stats = {0};
+
+/* Memory-mapped TPACKET_V3 receive ring (capture.mmap_ring) */
+#define NLMON_RX_RING_FRAME_SIZE 2048
+
+struct nlmon_rx_ring {
+	uint8_t *map;                         /* Mapped ring */
+	size_t size;                          /* Mapping size */
+	struct tpacket_block_desc **blocks;   /* Block descriptors */
+	unsigned int block_count;
+	unsigned int current;                 /* Next block to inspect */
+};
+
+static struct nlmon_rx_ring rx_ring = {0};
+
+static struct nlmon_capture_config capture_cfg = {
+	.mmap_ring = false,
+	.ring_block_size = 1024 * 1024,
+	.ring_block_count = 16,
+	.ring_block_timeout_ms = 64,
+};
+
+/* Thread placement, empty CPU lists leave threads to the scheduler */
+static struct nlmon_threads_config threads_cfg;
+
+#ifdef ENABLE_CONFIG
+static char *config_file = NULL;
+static struct nlmon_config_ctx g_config_ctx;
+static int g_config_loaded = 0;
+static pthread_t g_reload_thread;
+static atomic_bool g_reload_running;
+static bool g_reload_started;
+
+/* Compiled form of a configuration's filters, owned by its snapshot */
+struct config_filters {
+	int count;
+	struct filter_expr *expr[NLMON_MAX_FILTERS];
+	struct filter_bytecode *bc[NLMON_MAX_FILTERS];
+};
+#endif
 
 /* PCAP file format structures */
 struct pcap_file_header {
@@ -193,7 +413,36 @@ struct pcap_packet_header {
 
 static FILE *pcap_fp = NULL;
 
-static void log_event(const char *msg)
+/* Kind of an event for control clients, which count and query by it */
+static const char *control_event_type(const struct nlmon_event *evt)
+{
+	if (!evt)
+		return "log";
+	if (evt->netlink.protocol != NETLINK_ROUTE)
+		return "netlink";
+	switch (evt->netlink.msg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		return "link";
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		return "addr";
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE:
+		return "route";
+	case RTM_NEWNEIGH:
+	case RTM_DELNEIGH:
+		return "neigh";
+	case RTM_NEWRULE:
+	case RTM_DELRULE:
+		return "rule";
+	default:
+		return "netlink";
+	}
+}
+
+/* Log a line, from evt if it describes one */
+static void log_event_from(struct nlmon_event *evt, const char *msg)
 {
 	time_t now;
 	struct tm *tm_info;
@@ -220,6 +469,30 @@ static void log_event(const char *msg)
 	} else {
 		warnx("%s", msg);
 	}
+	
+	/* Lines come from more than the event thread, the feed takes one */
+	if (g_control) {
+		pthread_mutex_lock(&control_lock);
+		cli_control_publish(g_control, evt, control_event_type(evt),
+		                    evt ? evt->interface : "", msg);
+		pthread_mutex_unlock(&control_lock);
+	}
+}
+
+static void log_event(const char *msg)
+{
+	log_event_from(NULL, msg);
+}
+
+/* Deferred log records: netlink library lines keep their tagged stderr form */
+static void nlmon_log_sink(const struct nlmon_log_record *rec, const char *text, void *ctx)
+{
+	(void)ctx;
+
+	if (rec->site->tag)
+		nlmon_log_default_sink(rec, text, NULL);
+	else
+		log_event(text);
 }
 
 /* nlmon device management */
@@ -308,8 +581,144 @@ static int create_nlmon_device(const char *dev_name)
 	return -1;
 }
 
+static void nlmon_filter_cleanup(void)
+{
+	filter_eval_context_destroy(g_filter_pkt_ctx);
+	filter_eval_context_destroy(g_filter_nl_ctx);
+	filter_bytecode_free(g_filter_bc);
+	filter_expr_free(g_filter_expr);
+	g_filter_pkt_ctx = NULL;
+	g_filter_nl_ctx = NULL;
+	g_filter_bc = NULL;
+	g_filter_expr = NULL;
+}
+
+/* Parse the -f filter, a bare number is shorthand for a message type match */
+static int nlmon_filter_init(void)
+{
+	const char *str = filter_expression;
+	char buf[64];
+
+	if (!str) {
+		if (filter_msg_type < 0)
+			return 0;
+		snprintf(buf, sizeof(buf), "netlink.msg_type == %d", filter_msg_type);
+		str = buf;
+	}
+
+	g_filter_expr = filter_parse(str);
+	if (!g_filter_expr) {
+		warnx("Failed to allocate filter expression");
+		return -1;
+	}
+	if (!g_filter_expr->valid) {
+		warnx("Invalid filter expression '%s': %s", str,
+		      g_filter_expr->error.message);
+		nlmon_filter_cleanup();
+		return -1;
+	}
+
+	/* The numeric form keeps its direct nlmsg_type check */
+	if (!filter_expression)
+		return 0;
+
+	g_filter_bc = filter_compile(g_filter_expr);
+	g_filter_pkt_ctx = filter_eval_context_create();
+	g_filter_nl_ctx = filter_eval_context_create();
+	if (!g_filter_bc || !g_filter_pkt_ctx || !g_filter_nl_ctx) {
+		warnx("Failed to compile filter expression '%s'", str);
+		nlmon_filter_cleanup();
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Lower the -f filter to a kernel prefilter for one socket, NULL if it has none */
+static struct filter_cbpf *nlmon_filter_prefilter(int protocol, const char *what)
+{
+	struct filter_cbpf *prog = NULL;
+	char msg[256];
+	int ret;
+
+	if (!g_filter_expr)
+		return NULL;
+
+	ret = filter_compile_cbpf(g_filter_expr, protocol, &prog);
+	if (ret < 0) {
+		if (ret != -ENOTSUP)
+			warnx("Failed to compile kernel prefilter for %s: %s", what,
+			      strerror(-ret));
+		else if (verbose_mode) {
+			snprintf(msg, sizeof(msg),
+			         "Filter has no kernel-evaluable predicates for %s", what);
+			log_event(msg);
+		}
+		return NULL;
+	}
+
+	if (verbose_mode) {
+		snprintf(msg, sizeof(msg), "Kernel prefilter for %s: %u instructions%s",
+		         what, prog->len,
+		         prog->relaxed ? " (rest evaluated in user space)" : "");
+		log_event(msg);
+	}
+
+	return prog;
+}
+
+/* Install the -f prefilter on the netlink manager's sockets */
+static void nlmon_filter_prefilter_manager(struct nlmon_nl_manager *mgr)
+{
+	static const struct {
+		int protocol;
+		const char *name;
+	} protocols[] = {
+		{ NETLINK_ROUTE, "NETLINK_ROUTE" },
+		{ NETLINK_GENERIC, "NETLINK_GENERIC" },
+		{ NETLINK_SOCK_DIAG, "NETLINK_SOCK_DIAG" },
+		{ NETLINK_NETFILTER, "NETLINK_NETFILTER" },
+	};
+	struct filter_cbpf *prog;
+	size_t i;
+	int ret;
+
+	/* The numeric -f form only ever applied to the nlmon device */
+	if (!g_filter_bc)
+		return;
+
+	for (i = 0; i < sizeof(protocols) / sizeof(protocols[0]); i++) {
+		prog = nlmon_filter_prefilter(protocols[i].protocol, protocols[i].name);
+		if (!prog)
+			continue;
+		ret = nlmon_nl_set_filter(mgr, protocols[i].protocol, prog->insns, prog->len);
+		if (ret < 0)
+			warnx("Failed to set %s prefilter: %s", protocols[i].name,
+			      strerror(-ret));
+		filter_cbpf_free(prog);
+	}
+}
+
+/* Build the header-level event the -f filter sees for a captured message */
+static void nlmon_packet_event(struct nlmsghdr *nlh, int protocol,
+                               struct nlmon_event *evt)
+{
+	memset(evt, 0, sizeof(*evt));
+	evt->netlink.protocol = protocol;
+	nlmon_nl_extract_header(nlh, evt);
+
+	if (protocol == NETLINK_GENERIC && nlh->nlmsg_len >= NLMSG_LENGTH(GENL_HDRLEN)) {
+		struct genlmsghdr *gnlh = NLMSG_DATA(nlh);
+
+		evt->netlink.genl_cmd = gnlh->cmd;
+		evt->netlink.genl_version = gnlh->version;
+		evt->netlink.genl_family_id = nlh->nlmsg_type;
+	}
+}
+
 static int bind_nlmon_socket(const char *dev_name)
 {
+	struct filter_cbpf *prog;
 	struct sockaddr_ll sll;
 	struct ifreq ifr;
 	int sock;
@@ -343,6 +752,17 @@ static int bind_nlmon_socket(const char *dev_name)
 		return -1;
 	}
 
+	/* Drop messages the -f filter cannot match before they are copied */
+	prog = nlmon_filter_prefilter(FILTER_CBPF_ANY_PROTOCOL, dev_name);
+	if (prog) {
+		int ret = filter_cbpf_attach(sock, prog);
+
+		if (ret < 0)
+			warnx("Failed to attach kernel prefilter to %s: %s", dev_name,
+			      strerror(-ret));
+		filter_cbpf_free(prog);
+	}
+
 	if (verbose_mode) {
 		char msg[256];
 		snprintf(msg, sizeof(msg), "Bound to nlmon device %s (ifindex=%d)", 
@@ -418,6 +838,330 @@ static void write_pcap_packet(const unsigned char *data, size_t len)
 	fflush(pcap_fp);
 }
 
+#ifdef ENABLE_CONFIG
+static void config_filters_free(void *prepared)
+{
+	struct config_filters *filters = prepared;
+	
+	if (!filters)
+		return;
+	for (int i = 0; i < filters->count; i++) {
+		filter_bytecode_free(filters->bc[i]);
+		filter_expr_free(filters->expr[i]);
+	}
+	free(filters);
+}
+
+/* Compile the enabled filters of a configuration before it is published */
+static int config_prepare(struct nlmon_config *config, void *arg)
+{
+	struct config_filters *filters;
+	
+	(void)arg;
+	
+	filters = calloc(1, sizeof(*filters));
+	if (!filters)
+		return -1;
+	
+	for (int i = 0; i < config->filter_count && i < NLMON_MAX_FILTERS; i++) {
+		const struct nlmon_filter_config *f = &config->filters[i];
+		struct filter_expr *expr;
+		
+		if (!f->enabled || !f->expression[0])
+			continue;
+		
+		expr = filter_parse(f->expression);
+		if (!expr || !expr->valid) {
+			warnx("Invalid filter '%s': %s", f->name,
+			      expr ? expr->error.message : "out of memory");
+			filter_expr_free(expr);
+			config_filters_free(filters);
+			return -1;
+		}
+		filters->expr[filters->count] = expr;
+		filters->bc[filters->count] = filter_compile(expr);
+		if (!filters->bc[filters->count++]) {
+			warnx("Failed to compile filter '%s'", f->name);
+			config_filters_free(filters);
+			return -1;
+		}
+	}
+	
+	config->prepared = filters;
+	config->prepared_free = config_filters_free;
+	return 0;
+}
+
+/* Whether an event passes the configured filters, any one of them will do */
+static bool config_filters_match(struct nlmon_event *evt)
+{
+	const struct nlmon_config *config;
+	const struct config_filters *filters;
+	unsigned token;
+	bool match = true;
+	
+	if (!g_config_loaded)
+		return true;
+	
+	config = nlmon_config_read_begin(&g_config_ctx, &token);
+	filters = config ? config->prepared : NULL;
+	if (filters && filters->count > 0) {
+		match = false;
+		for (int i = 0; i < filters->count && !match; i++)
+			match = filter_eval(filters->bc[i], evt, NULL);
+	}
+	nlmon_config_read_end(&g_config_ctx, token);
+	return match;
+}
+
+static void *config_reload_thread(void *arg)
+{
+	int err;
+	
+	(void)arg;
+	
+	err = nlmon_config_ctx_reload(&g_config_ctx);
+	if (err != NLMON_CONFIG_OK)
+		warnx("Configuration reload failed: %s", nlmon_config_error_string(err));
+	atomic_store(&g_reload_running, false);
+	return NULL;
+}
+#endif
+
+static void log_startup_phase(int phase)
+{
+	struct startup_phase_info info;
+	char msg[160];
+	
+	if (startup_graph_info(g_startup, phase, &info) < 0)
+		return;
+	snprintf(msg, sizeof(msg), "Startup: %s %s at %.1f ms, took %.1f ms",
+	         info.name, startup_state_name(info.state),
+	         info.start_ns / 1e6, info.duration_ns / 1e6);
+	log_event(msg);
+}
+
+static void startup_mark(const char *name)
+{
+	uint64_t now = nlmon_clock_precise_ns();
+	
+	if (g_startup_mark_count < STARTUP_MAX_MARKS) {
+		g_startup_marks[g_startup_mark_count].name = name;
+		g_startup_marks[g_startup_mark_count].start_ns = g_startup_last_ns - g_startup_begin_ns;
+		g_startup_marks[g_startup_mark_count].duration_ns = now - g_startup_last_ns;
+		g_startup_mark_count++;
+	}
+	g_startup_last_ns = now;
+}
+
+static void startup_report_line(const char *name, const char *stage, uint64_t start_ns,
+                                uint64_t duration_ns)
+{
+	char label[64];
+	
+	if (stage)
+		snprintf(label, sizeof(label), "%s.%s", name, stage);
+	else
+		snprintf(label, sizeof(label), "%s", name);
+	printf("%-28s %10.3f %10.3f\n", label, start_ns / 1e6, duration_ns / 1e6);
+}
+
+#ifdef ENABLE_CONFIG
+static void startup_report_config(const char *name, uint64_t start_ns,
+                                  const struct nlmon_config_timing *timing)
+{
+	startup_report_line(name, "load", start_ns, timing->load_ns);
+	start_ns += timing->load_ns;
+	startup_report_line(name, "validate", start_ns, timing->validate_ns);
+	start_ns += timing->validate_ns;
+	startup_report_line(name, "prepare", start_ns, timing->prepare_ns);
+	start_ns += timing->prepare_ns;
+	if (timing->reloads)
+		startup_report_line(name, "publish", start_ns, timing->publish_ns);
+}
+#endif
+
+/* -Z: the phases of main, those of the startup graph within theirs and
+ * the stages of each reload, in milliseconds from the start of main */
+static void startup_report(void)
+{
+	uint64_t ready = g_startup_last_ns - g_startup_begin_ns;
+	
+	printf("%-28s %10s %10s\n", "phase", "start_ms", "took_ms");
+	for (int i = 0; i < g_startup_mark_count; i++) {
+		startup_report_line(g_startup_marks[i].name, NULL, g_startup_marks[i].start_ns,
+		                    g_startup_marks[i].duration_ns);
+#ifdef ENABLE_CONFIG
+		if (g_config_loaded && strcmp(g_startup_marks[i].name, "config") == 0) {
+			struct nlmon_config_timing timing;
+			
+			nlmon_config_ctx_get_timing(&g_config_ctx, &timing);
+			startup_report_config("config", g_startup_marks[i].start_ns, &timing);
+		}
+#endif
+		if (i == g_subsystems_mark) {
+			for (int p = 0; p < startup_graph_count(g_startup); p++) {
+				struct startup_phase_info info;
+				
+				if (startup_graph_info(g_startup, p, &info) < 0 ||
+				    info.state == STARTUP_PENDING)
+					continue;
+				startup_report_line("subsystems", info.name,
+				                    g_startup_marks[i].start_ns + info.start_ns,
+				                    info.duration_ns);
+			}
+		}
+	}
+	startup_report_line("ready", NULL, 0, ready);
+	
+#ifdef ENABLE_CONFIG
+	for (int i = 1; g_config_loaded && i <= startup_report_reloads; i++) {
+		uint64_t start = nlmon_clock_precise_ns() - g_startup_begin_ns;
+		struct nlmon_config_timing timing;
+		char name[32];
+		int err;
+		
+		err = nlmon_config_ctx_reload(&g_config_ctx);
+		if (err != NLMON_CONFIG_OK) {
+			warnx("Configuration reload failed: %s", nlmon_config_error_string(err));
+			break;
+		}
+		nlmon_config_ctx_get_timing(&g_config_ctx, &timing);
+		snprintf(name, sizeof(name), "reload.%d", i);
+		startup_report_line(name, NULL, start, timing.total_ns);
+		startup_report_config(name, start, &timing);
+	}
+	if (!g_config_loaded && startup_report_reloads > 0)
+		warnx("No configuration (-C) to reload");
+#else
+	if (startup_report_reloads > 0)
+		warnx("Built without configuration support, nothing to reload");
+#endif
+	fflush(stdout);
+}
+
+#ifdef ENABLE_QCA
+/* QCA control is started by the first event that needs it */
+static bool qca_control_ready(void)
+{
+	static atomic_bool logged;
+	
+	if (atomic_load(&g_qca_ready))
+		return true;
+	
+	startup_graph_start(g_startup, g_qca_phase);
+	if (startup_graph_wait(g_startup, g_qca_phase) != STARTUP_DONE)
+		return false;
+	if (verbose_mode && !atomic_exchange(&logged, true))
+		log_startup_phase(g_qca_phase);
+	return true;
+}
+
+/* Changed link stats pass the filters into the log like netlink events */
+static void qca_stats_sink(struct nlmon_event *evt, void *user_data)
+{
+	const struct qca_stats_counter *counters = evt->data;
+	size_t count = evt->data_size / sizeof(*counters);
+	char buf[512];
+	size_t len;
+	
+	(void)user_data;
+	
+	if (g_filter_bc && !filter_eval(g_filter_bc, evt, g_filter_nl_ctx))
+		return;
+	
+#ifdef ENABLE_CONFIG
+	if (!config_filters_match(evt))
+		return;
+#endif
+	
+	len = snprintf(buf, sizeof(buf), "QCA: %s link stats, %zu changed:", evt->interface, count);
+	for (size_t i = 0; i < count && len < sizeof(buf); i++) {
+		char key[32];
+		
+		qca_stats_key_format(counters[i].key, key, sizeof(key));
+		len += snprintf(buf + len, sizeof(buf) - len, " %s=%llu(%+lld)", key,
+		                (unsigned long long)counters[i].value,
+		                (long long)counters[i].delta);
+	}
+	event_stats.generic_events++;
+	log_event_from(evt, buf);
+}
+
+/* Polls run from the loop, each at a jittered distance from the last */
+static void qca_poll_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	static bool unavailable;
+	bool failed;
+	
+	(void)revents;
+	
+	g_timer_wakeups++;
+	
+	/* Polls go on, nl80211 may come with a driver loaded later */
+	failed = qca_stats_poller_poll(g_stats_poller) < 0;
+	if (failed && !unavailable && verbose_mode)
+		log_event("QCA link stats: nl80211 not available");
+	unavailable = failed;
+	
+	ev_timer_set(w, qca_stats_poller_next_ms(g_stats_poller) / 1000.0, 0.0);
+	ev_timer_start(loop, w);
+}
+
+/* Start polling the -L interfaces, or the -q interface when none are given */
+static int qca_poll_start(struct ev_loop *loop)
+{
+	struct qca_stats_poller_config config = {
+		.jitter_pct = QCA_POLL_JITTER_PCT,
+		.sink = qca_stats_sink,
+	};
+	const char *ifnames[QCA_STATS_MAX_INTERFACES];
+	char *spec, *ifname, *save = NULL;
+	unsigned long secs;
+	
+	spec = strdup(qca_poll_spec);
+	if (!spec)
+		return -1;
+	
+	secs = strtoul(strtok_r(spec, ",", &save) ?: "", &ifname, 10);
+	if (!secs || *ifname) {
+		warnx("Invalid link stats interval: %s", qca_poll_spec);
+		free(spec);
+		return -1;
+	}
+	config.interval_ms = secs * 1000;
+	
+	while ((ifname = strtok_r(NULL, ",", &save)) && config.count < QCA_STATS_MAX_INTERFACES)
+		ifnames[config.count++] = ifname;
+	if (!config.count)
+		ifnames[config.count++] = qca_interface;
+	config.ifnames = ifnames;
+	
+	/* The poller keeps its own copy of the names */
+	g_stats_poller = qca_stats_poller_create(&config);
+	free(spec);
+	if (!g_stats_poller)
+		return -1;
+	
+	ev_timer_init(&qca_poll_timer, qca_poll_cb,
+	              qca_stats_poller_next_ms(g_stats_poller) / 1000.0, 0.0);
+	ev_timer_start(loop, &qca_poll_timer);
+	return 0;
+}
+#endif
+
+/* The family name travels in the record, args: id, cmd, version, name */
+static int render_genl_debug(const struct nlmon_log_record *rec, char *buf, size_t len)
+{
+	char name[4 * sizeof(uint64_t) + 1];
+
+	memcpy(name, &rec->args[3], 4 * sizeof(uint64_t));
+	name[sizeof(name) - 1] = '\0';
+	return snprintf(buf, len, "[DEBUG] GenL: family=%s(%u) cmd=%u ver=%u", name,
+	                (unsigned int)rec->args[0], (unsigned int)rec->args[1],
+	                (unsigned int)rec->args[2]);
+}
+
 /* Netlink manager event callback */
 static void netlink_manager_event_cb(struct nlmon_event *evt, void *user_data)
 {
@@ -428,33 +1172,54 @@ static void netlink_manager_event_cb(struct nlmon_event *evt, void *user_data)
 	if (!evt)
 		return;
 	
-	/* Debug: Show raw netlink message details */
+	/* Apply the -f filter expression */
+	if (g_filter_bc && !filter_eval(g_filter_bc, evt, g_filter_nl_ctx))
+		return;
+	
+#ifdef ENABLE_CONFIG
+	/* And the filters of the current configuration */
+	if (!config_filters_match(evt))
+		return;
+#endif
+	
+	nlmon_trace_stamp(&evt->trace, NLMON_TRACE_FILTER);
+	
+	/* Dropped events were never decoded, the rest is consumed in full */
+	nlmon_event_materialize(evt);
+	
+	/* Debug: Show raw netlink message details, formatted off this thread */
 	if (debug_netlink) {
-		snprintf(buf, sizeof(buf), 
-		         "[DEBUG] Netlink msg: proto=%d type=%u flags=0x%x seq=%u pid=%u",
-		         evt->netlink.protocol,
-		         evt->netlink.msg_type,
-		         evt->netlink.msg_flags,
-		         evt->netlink.seq,
-		         evt->netlink.pid);
-		log_event(buf);
+		NLMON_LOG(NLMON_LOG_DEBUG, NULL,
+		          "[DEBUG] Netlink msg: proto=%d type=%u flags=0x%x seq=%u pid=%u netns=%llu",
+		          evt->netlink.protocol,
+		          evt->netlink.msg_type,
+		          evt->netlink.msg_flags,
+		          evt->netlink.seq,
+		          evt->netlink.pid,
+		          (unsigned long long)evt->netlink.netns);
 		
 		/* Show generic netlink details if applicable */
 		if (evt->netlink.protocol == NETLINK_GENERIC) {
-			snprintf(buf, sizeof(buf),
-			         "[DEBUG] GenL: family=%s(%u) cmd=%u ver=%u",
-			         evt->netlink.genl_family_name,
-			         evt->netlink.genl_family_id,
-			         evt->netlink.genl_cmd,
-			         evt->netlink.genl_version);
-			log_event(buf);
+			uint64_t name[4] = { 0 };
+			
+			memcpy(name, evt->netlink.genl_family_name,
+			       sizeof(evt->netlink.genl_family_name) < sizeof(name) ?
+			       sizeof(evt->netlink.genl_family_name) : sizeof(name));
+			NLMON_LOG_RENDER(NLMON_LOG_DEBUG, NULL, render_genl_debug,
+			                 evt->netlink.genl_family_id,
+			                 evt->netlink.genl_cmd,
+			                 evt->netlink.genl_version,
+			                 name[0], name[1], name[2], name[3]);
 		}
 	}
 	
+#ifdef ENABLE_QCA
 	/* Process QCA integration if enabled */
-	if (enable_qca_control && evt->netlink.protocol == NETLINK_GENERIC) {
+	if (enable_qca_control && evt->netlink.protocol == NETLINK_GENERIC &&
+	    qca_control_ready()) {
 		qca_nlmon_process_nl80211_event(evt);
 	}
+#endif
 	
 	/* Handle netlink events from the new manager */
 	switch (evt->netlink.protocol) {
@@ -484,7 +1249,7 @@ static void netlink_manager_event_cb(struct nlmon_event *evt, void *user_data)
 				         evt->netlink.data.link->addr[2], evt->netlink.data.link->addr[3],
 				         evt->netlink.data.link->addr[4], evt->netlink.data.link->addr[5]);
 				event_stats.generic_events++;
-				log_event(buf);
+				log_event_from(evt, buf);
 			}
 			break;
 		case RTM_NEWADDR:
@@ -505,7 +1270,7 @@ static void netlink_manager_event_cb(struct nlmon_event *evt, void *user_data)
 				         scope,
 				         evt->netlink.data.addr->label[0] ? evt->netlink.data.addr->label : "?");
 				event_stats.generic_events++;
-				log_event(buf);
+				log_event_from(evt, buf);
 			}
 			break;
 		case RTM_NEWROUTE:
@@ -523,7 +1288,7 @@ static void netlink_manager_event_cb(struct nlmon_event *evt, void *user_data)
 				         evt->netlink.data.route->oif,
 				         evt->netlink.data.route->priority);
 				event_stats.generic_events++;
-				log_event(buf);
+				log_event_from(evt, buf);
 			}
 			break;
 		case RTM_NEWNEIGH:
@@ -550,7 +1315,7 @@ static void netlink_manager_event_cb(struct nlmon_event *evt, void *user_data)
 				         evt->netlink.data.neigh->lladdr[4], evt->netlink.data.neigh->lladdr[5],
 				         state_str[0] ? state_str : "NONE");
 				event_stats.generic_events++;
-				log_event(buf);
+				log_event_from(evt, buf);
 			}
 			break;
 		}
@@ -588,7 +1353,7 @@ static void netlink_manager_event_cb(struct nlmon_event *evt, void *user_data)
 			         evt->netlink.data.nl80211->freq,
 			         evt->netlink.data.nl80211->iftype);
 			event_stats.generic_events++;
-			log_event(buf);
+			log_event_from(evt, buf);
 		} else {
 			snprintf(buf, sizeof(buf), "GENL: family=%s cmd=%d version=%d family_id=%u",
 			         evt->netlink.genl_family_name,
@@ -596,7 +1361,7 @@ static void netlink_manager_event_cb(struct nlmon_event *evt, void *user_data)
 			         evt->netlink.genl_version,
 			         evt->netlink.genl_family_id);
 			event_stats.generic_events++;
-			log_event(buf);
+			log_event_from(evt, buf);
 		}
 		break;
 		
@@ -610,7 +1375,7 @@ static void netlink_manager_event_cb(struct nlmon_event *evt, void *user_data)
 			         evt->netlink.data.diag->state,
 			         evt->netlink.data.diag->protocol);
 			event_stats.sock_diag_events++;
-			log_event(buf);
+			log_event_from(evt, buf);
 		}
 		break;
 		
@@ -625,7 +1390,7 @@ static void netlink_manager_event_cb(struct nlmon_event *evt, void *user_data)
 			         evt->netlink.data.conntrack->tcp_state,
 			         evt->netlink.data.conntrack->bytes_orig);
 			event_stats.generic_events++;
-			log_event(buf);
+			log_event_from(evt, buf);
 		}
 		break;
 	}
@@ -662,6 +1427,7 @@ static void genetlink_event_cb(nlmon_event_type_t type, void *data, void *user_d
 	}
 }
 
+#ifdef ENABLE_QCA
 /* Simple WMI filter matching function */
 static int wmi_filter_match(const struct wmi_log_entry *entry, const char *filter_expr)
 {
@@ -704,15 +1470,42 @@ static int wmi_filter_match(const struct wmi_log_entry *entry, const char *filte
 	return 1;
 }
 
-/* WMI log line callback */
-static int wmi_log_line_cb(const char *line, void *user_data)
+/* Filter, log and submit a parsed WMI entry */
+static void wmi_handle_entry(const struct wmi_source *source,
+                             const struct wmi_log_entry *entry)
 {
-	struct wmi_log_entry entry;
 	char buf[512];
-	int ret;
-
-	(void)user_data;
-
+	int len = 0;
+	
+	/* Apply WMI filter if specified */
+	if (wmi_filter_expr && !wmi_filter_match(entry, wmi_filter_expr)) {
+		return;  /* Filtered out */
+	}
+	
+	/* Tell the sources apart when there are several */
+	if (wmi_source_count > 1) {
+		len = snprintf(buf, sizeof(buf), "%s: ", source->path);
+		if (len < 0 || (size_t)len >= sizeof(buf) / 2) {
+			len = 0;
+		}
+	}
+	
+	/* Format and log the WMI event */
+	if (wmi_format_entry(entry, buf + len, sizeof(buf) - len) > 0) {
+		log_event(buf);
+		
+		/* Submit to event bridge if available */
+		wmi_bridge_submit(entry);
+	}
+}
+
+/* WMI log line callback */
+static int wmi_log_line_cb(const char *line, void *user_data)
+{
+	struct wmi_log_entry entry;
+	char buf[512];
+	int ret;
+
 	/* Parse the WMI log line */
 	ret = wmi_parse_log_line(line, &entry);
 	if (ret < 0) {
@@ -724,130 +1517,525 @@ static int wmi_log_line_cb(const char *line, void *user_data)
 		return 0;  /* Continue processing */
 	}
 	
-	/* Apply WMI filter if specified */
-	if (wmi_filter_expr && !wmi_filter_match(&entry, wmi_filter_expr)) {
-		return 0;  /* Filtered out */
-	}
+	nlmon_heartbeat_enter("wmi-entry");
+	wmi_handle_entry(user_data, &entry);
+	nlmon_heartbeat_leave(NULL);
+	return 0;
+}
+
+/* WMI replay sink, entries arrive in timestamp order */
+static int wmi_replay_sink(const struct wmi_log_entry *entry, void *user_data)
+{
+	wmi_handle_entry(user_data, entry);
+	return 0;
+}
+
+/* WMI replay progress callback */
+static void wmi_replay_progress_cb(const struct wmi_replay_progress *progress,
+                                   void *user_data)
+{
+	char msg[256];
 	
-	/* Format and log the WMI event */
-	ret = wmi_format_entry(&entry, buf, sizeof(buf));
-	if (ret > 0) {
-		log_event(buf);
-		
-		/* Submit to event bridge if available */
-		wmi_bridge_submit(&entry);
+	(void)user_data;
+	
+	if (!verbose_mode) {
+		return;
 	}
 	
-	return 0;
+	snprintf(msg, sizeof(msg),
+	         "wmi replay: %llu/%llu bytes, %llu entries, %llu parse errors, %.1f MB/s",
+	         (unsigned long long)progress->bytes_parsed,
+	         (unsigned long long)progress->bytes_total,
+	         (unsigned long long)progress->entries,
+	         (unsigned long long)progress->parse_errors,
+	         progress->bytes_per_sec / (1024 * 1024));
+	log_event(msg);
 }
 
-/* WMI reader thread function */
+/* WMI reader thread function, one per source */
 static void *wmi_reader_thread(void *arg)
 {
-	(void)arg;
+	struct wmi_source *source = arg;
 	
+	nlmon_heartbeat_register("wmi-reader", NULL, NULL);
 	if (verbose_mode) {
 		log_event("WMI reader thread started");
 	}
 	
-	/* Start reading WMI logs - this blocks until stopped or EOF */
-	wmi_log_reader_start();
+	if (wmi_replay_mode) {
+		struct wmi_replay_config config = {
+			.log_source = source->path,
+			.sink = wmi_replay_sink,
+			.progress = wmi_replay_progress_cb,
+			.user_data = source,
+		};
+		
+		/* Replay the whole file on all cores - this blocks until stopped or done */
+		if (wmi_replay_run(&config, NULL) < 0) {
+			warnx("Failed to replay WMI log: %s", source->path);
+		}
+	} else {
+		/* Start reading WMI logs - this blocks until stopped or EOF */
+		wmi_log_reader_run(source->reader);
+	}
 	
 	if (verbose_mode) {
 		log_event("WMI reader thread stopped");
 	}
 	
+	nlmon_heartbeat_unregister();
 	return NULL;
 }
 
-/* Generic netlink I/O callback */
-static void genetlink_io_cb(struct ev_loop *loop, ev_io *w, int revents)
+/* Embedded mode: read a source from the loop, going on when idle if
+ * there is more and dropping its watchers once it is done */
+static void wmi_source_poll(struct ev_loop *loop, struct wmi_source *source)
 {
-	(void)loop;
-	(void)revents;
+	int ret = wmi_log_reader_poll(source->reader);
 	
-	nlmon_protocol_t proto = (nlmon_protocol_t)(intptr_t)w->data;
-	
-	if (g_multi_proto_ctx) {
-		nlmon_multi_protocol_process(g_multi_proto_ctx, proto);
+	if (ret == WMI_LOG_POLL_MORE) {
+		ev_idle_start(loop, &source->idle);
+		return;
 	}
+	ev_idle_stop(loop, &source->idle);
+	if (ret == WMI_LOG_POLL_WAIT)
+		return;
+	
+	if (ret < 0)
+		warnx("Failed to read WMI log: %s", source->path);
+	else if (verbose_mode)
+		log_event("WMI source read to its end");
+	ev_io_stop(loop, &source->io);
+	ev_timer_stop(loop, &source->timer);
 }
 
-static void nlmon_packet_cb(struct ev_loop *loop, ev_io *w, int revents)
+static void wmi_io_cb(struct ev_loop *loop, ev_io *w, int revents)
 {
-	unsigned char buffer[MAX_NETLINK_PACKET_SIZE];
-	ssize_t len;
-	struct nlmsghdr *nlh;
-	char msg[512];
-	char msg_type_buf[32];
-	static unsigned long packet_count = 0;
-	const char *msg_type_str = "UNKNOWN";
+	(void)revents;
 	
-	len = recv(nlmon_sock, buffer, sizeof(buffer), 0);
-	if (len < 0) {
-		if (errno != EAGAIN && errno != EWOULDBLOCK)
-			warn("Failed to receive from nlmon socket");
-		return;
-	}
+	wmi_source_poll(loop, w->data);
+}
+
+static void wmi_timer_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	(void)revents;
 	
-	if (len == 0)
-		return;
+	g_timer_wakeups++;
+	wmi_source_poll(loop, w->data);
+}
+
+static void wmi_idle_cb(struct ev_loop *loop, ev_idle *w, int revents)
+{
+	(void)revents;
 	
-	packet_count++;
+	wmi_source_poll(loop, w->data);
+}
+
+/* Embedded mode: watch the sources on the loop, reading what they have
+ * once it runs */
+static void wmi_sources_watch(struct ev_loop *loop)
+{
+	int i;
 	
-	/* Parse netlink message */
-	if (len >= (ssize_t)sizeof(struct nlmsghdr)) {
-		nlh = (struct nlmsghdr *)buffer;
+	for (i = 0; i < wmi_source_count; i++) {
+		struct wmi_source *source = &wmi_sources[i];
+		int interval_ms, fd;
 		
-		/* Apply message type filter if set */
-		if (filter_msg_type >= 0 && nlh->nlmsg_type != (unsigned)filter_msg_type)
-			return;
+		if (!source->reader)
+			continue;
 		
-		/* Determine message type description */
-		switch (nlh->nlmsg_type) {
-		case 0: msg_type_str = "NLMSG_NOOP"; break;
-		case 1: msg_type_str = "NLMSG_ERROR"; break;
-		case 2: msg_type_str = "NLMSG_DONE"; break;
-		case 3: msg_type_str = "NLMSG_OVERRUN"; break;
-		case 16: msg_type_str = "RTM_NEWLINK"; break;
-		case 17: msg_type_str = "RTM_DELLINK"; break;
-		case 18: msg_type_str = "RTM_GETLINK"; break;
-		case 19: msg_type_str = "RTM_SETLINK"; break;
-		case 20: msg_type_str = "RTM_NEWADDR"; break;
-		case 21: msg_type_str = "RTM_DELADDR"; break;
-		case 22: msg_type_str = "RTM_GETADDR"; break;
-		case 24: msg_type_str = "RTM_NEWROUTE"; break;
-		case 25: msg_type_str = "RTM_DELROUTE"; break;
-		case 26: msg_type_str = "RTM_GETROUTE"; break;
-		case 28: msg_type_str = "RTM_NEWNEIGH"; break;
-		case 29: msg_type_str = "RTM_DELNEIGH"; break;
-		case 30: msg_type_str = "RTM_GETNEIGH"; break;
-		case 32: msg_type_str = "RTM_NEWRULE"; break;
-		case 33: msg_type_str = "RTM_DELRULE"; break;
-		case 34: msg_type_str = "RTM_GETRULE"; break;
-		default:
-			if (nlh->nlmsg_type >= 16)
-				snprintf(msg_type_buf, sizeof(msg_type_buf), "RTM_%u", nlh->nlmsg_type);
-			else
-				snprintf(msg_type_buf, sizeof(msg_type_buf), "TYPE_%u", nlh->nlmsg_type);
-			msg_type_str = msg_type_buf;
-			break;
+		fd = wmi_log_reader_watch(source->reader, &interval_ms);
+		if (fd >= 0) {
+			ev_io_init(&source->io, wmi_io_cb, fd, EV_READ);
+			source->io.data = source;
+			ev_io_start(loop, &source->io);
+		}
+		if (interval_ms) {
+			ev_timer_init(&source->timer, wmi_timer_cb, interval_ms / 1000.0,
+			              interval_ms / 1000.0);
+			source->timer.data = source;
+			ev_timer_start(loop, &source->timer);
+		}
+		ev_idle_init(&source->idle, wmi_idle_cb);
+		source->idle.data = source;
+		ev_idle_start(loop, &source->idle);
+	}
+}
+
+/* Stop the WMI reader threads and free their readers */
+static void wmi_sources_stop(void)
+{
+	int i;
+	
+	if (wmi_replay_mode) {
+		wmi_replay_stop();
+	}
+	for (i = 0; i < wmi_source_count; i++) {
+		wmi_log_reader_interrupt(wmi_sources[i].reader);
+	}
+	
+	for (i = 0; i < wmi_source_count; i++) {
+		struct wmi_source *source = &wmi_sources[i];
+		
+		/* Wait for thread to finish */
+		if (source->thread_started) {
+			pthread_join(source->thread, NULL);
+			source->thread_started = 0;
 		}
+		wmi_log_reader_destroy(source->reader);
+		source->reader = NULL;
 	}
+}
+#endif /* ENABLE_QCA */
+
+/* Legacy multi-protocol sockets, all of them behind one epoll fd */
+static void genetlink_io_cb(struct ev_loop *loop, ev_io *w, int revents)
+{
+	(void)loop;
+	(void)w;
+	(void)revents;
 	
+	if (g_multi_proto_ctx) {
+		nlmon_multi_protocol_dispatch(g_multi_proto_ctx);
+	}
+}
+
+/* Human readable name for the netlink message types seen on nlmon */
+static const char *nlmon_msg_type_str(uint16_t type, char *buf, size_t len)
+{
+	switch (type) {
+	case 0: return "NLMSG_NOOP";
+	case 1: return "NLMSG_ERROR";
+	case 2: return "NLMSG_DONE";
+	case 3: return "NLMSG_OVERRUN";
+	case 16: return "RTM_NEWLINK";
+	case 17: return "RTM_DELLINK";
+	case 18: return "RTM_GETLINK";
+	case 19: return "RTM_SETLINK";
+	case 20: return "RTM_NEWADDR";
+	case 21: return "RTM_DELADDR";
+	case 22: return "RTM_GETADDR";
+	case 24: return "RTM_NEWROUTE";
+	case 25: return "RTM_DELROUTE";
+	case 26: return "RTM_GETROUTE";
+	case 28: return "RTM_NEWNEIGH";
+	case 29: return "RTM_DELNEIGH";
+	case 30: return "RTM_GETNEIGH";
+	case 32: return "RTM_NEWRULE";
+	case 33: return "RTM_DELRULE";
+	case 34: return "RTM_GETRULE";
+	default:
+		if (type >= 16)
+			snprintf(buf, len, "RTM_%u", type);
+		else
+			snprintf(buf, len, "TYPE_%u", type);
+		return buf;
+	}
+}
+
+/* Allocate the receive batch used by nlmon_packet_cb */
+static int nlmon_rx_batch_init(unsigned int batch)
+{
+	unsigned int i;
+
+	if (batch == 0)
+		batch = 1;
+	if (batch > NLMON_RX_BATCH_MAX)
+		batch = NLMON_RX_BATCH_MAX;
+
+	rx_bufs = calloc(batch, MAX_NETLINK_PACKET_SIZE);
+	rx_iov = calloc(batch, sizeof(*rx_iov));
+	rx_msgs = calloc(batch, sizeof(*rx_msgs));
+	rx_addrs = calloc(batch, sizeof(*rx_addrs));
+	if (!rx_bufs || !rx_iov || !rx_msgs || !rx_addrs) {
+		free(rx_bufs);
+		free(rx_iov);
+		free(rx_msgs);
+		free(rx_addrs);
+		rx_bufs = NULL;
+		rx_iov = NULL;
+		rx_msgs = NULL;
+		rx_addrs = NULL;
+		return -1;
+	}
+
+	for (i = 0; i < batch; i++) {
+		rx_iov[i].iov_base = rx_bufs + (size_t)i * MAX_NETLINK_PACKET_SIZE;
+		rx_iov[i].iov_len = MAX_NETLINK_PACKET_SIZE;
+		rx_msgs[i].msg_hdr.msg_iov = &rx_iov[i];
+		rx_msgs[i].msg_hdr.msg_iovlen = 1;
+		rx_msgs[i].msg_hdr.msg_name = &rx_addrs[i];
+		rx_msgs[i].msg_hdr.msg_namelen = sizeof(rx_addrs[i]);
+	}
+
+	nlmon_rx_batch = batch;
+	return 0;
+}
+
+static void nlmon_rx_batch_cleanup(void)
+{
+	free(rx_bufs);
+	free(rx_iov);
+	free(rx_msgs);
+	free(rx_addrs);
+	rx_bufs = NULL;
+	rx_iov = NULL;
+	rx_msgs = NULL;
+	rx_addrs = NULL;
+}
+
+/* Verbose line of a captured message, args: packet, length, type, flags, seq, pid */
+static int render_packet_msg(const struct nlmon_log_record *rec, char *buf, size_t len)
+{
+	char msg_type_buf[32];
+
+	return snprintf(buf, len, "nlmon: pkt #%llu, len=%llu, %s, flags=0x%x, seq=%u, pid=%u",
+	                (unsigned long long)rec->args[0], (unsigned long long)rec->args[1],
+	                nlmon_msg_type_str((uint16_t)rec->args[2], msg_type_buf,
+	                                   sizeof(msg_type_buf)),
+	                (unsigned int)rec->args[3], (unsigned int)rec->args[4],
+	                (unsigned int)rec->args[5]);
+}
+
+/* Captured datagram passed to nlmon_packet_msg_cb() */
+struct nlmon_packet_info {
+	size_t len;
+	int protocol;           /* Netlink protocol of the tapped socket */
+};
+
+/* Per-message handler for nlmon_iterate_messages_optimized() */
+static int nlmon_packet_msg_cb(struct nlmsghdr *nlh, void *arg)
+{
+	struct nlmon_packet_info *info = arg;
+
+	/* Apply message type filter if set */
+	if (filter_msg_type >= 0 && nlh->nlmsg_type != (unsigned)filter_msg_type)
+		return -1;
+
+	/* Apply filter expression if set */
+	if (g_filter_bc) {
+		struct nlmon_event evt;
+
+		nlmon_packet_event(nlh, info->protocol, &evt);
+		if (!filter_eval(g_filter_bc, &evt, g_filter_pkt_ctx))
+			return -1;
+	}
+
+	rx_stats.messages++;
+
+	/* Log netlink message if verbose, formatted off the receive path */
+	if (verbose_mode)
+		NLMON_LOG_RENDER(NLMON_LOG_DEBUG, NULL, render_packet_msg,
+		                 rx_stats.packets, info->len, nlh->nlmsg_type,
+		                 nlh->nlmsg_flags, nlh->nlmsg_seq, nlh->nlmsg_pid);
+
+	return 0;
+}
+
+/* Process one datagram captured on the nlmon device */
+static void nlmon_handle_packet(unsigned char *buffer, size_t len, int protocol)
+{
+	struct nlmon_packet_info info = { .len = len, .protocol = protocol };
+	int matched = 0;
+
+	if (len == 0)
+		return;
+
+	rx_stats.packets++;
+
+	/* Walk every netlink message carried in the datagram */
+	if (len >= sizeof(struct nlmsghdr))
+		matched = nlmon_iterate_messages_optimized(buffer, len,
+		                                          nlmon_packet_msg_cb, &info);
+
+	/* Only record datagrams that passed the -f filter */
+	if (g_filter_expr && matched <= 0)
+		return;
+
 	/* Write to PCAP file if enabled */
 	if (pcap_fp)
 		write_pcap_packet(buffer, len);
-	
-	/* Log netlink message if verbose */
-	if (verbose_mode && len >= (ssize_t)sizeof(struct nlmsghdr)) {
-		nlh = (struct nlmsghdr *)buffer;
-		snprintf(msg, sizeof(msg), 
-		         "nlmon: pkt #%lu, len=%zd, %s, flags=0x%x, seq=%u, pid=%u",
-		         packet_count, len, msg_type_str, nlh->nlmsg_flags, 
-		         nlh->nlmsg_seq, nlh->nlmsg_pid);
-		log_event(msg);
+}
+
+static void nlmon_packet_cb(struct ev_loop *loop, ev_io *w, int revents)
+{
+	int count;
+	int i;
+
+	if (!rx_msgs)
+		return;
+
+	/* Pull as many datagrams as are queued, up to the batch size, in one syscall */
+	count = recvmmsg(nlmon_sock, rx_msgs, nlmon_rx_batch, MSG_DONTWAIT, NULL);
+	if (count < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			warn("Failed to receive from nlmon socket");
+		return;
+	}
+
+	rx_stats.wakeups++;
+	if (count == 0)
+		return;
+
+	rx_stats.batches++;
+	if ((unsigned int)count > rx_stats.max_batch)
+		rx_stats.max_batch = count;
+	if ((unsigned int)count == nlmon_rx_batch)
+		rx_stats.full_batches++;
+
+	for (i = 0; i < count; i++) {
+		if (rx_msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+			rx_stats.truncated++;
+		nlmon_handle_packet(rx_iov[i].iov_base, rx_msgs[i].msg_len,
+		                    ntohs(rx_addrs[i].sll_protocol));
+	}
+}
+
+/* Process one nlmon datagram received through io_uring (-U) */
+static void nlmon_recv_cb(void *ctx, int source, const struct io_recv_msg *msg, int error)
+{
+	const struct sockaddr_ll *sll;
+
+	if (error) {
+		/* Dropped datagrams are counted by the socket, only stop on real errors */
+		if (error != -ENOBUFS)
+			warnx("Failed to receive from nlmon socket: %s", strerror(-error));
+		return;
+	}
+
+	if (msg->truncated)
+		rx_stats.truncated++;
+	sll = msg->name;
+	nlmon_handle_packet(msg->data, msg->len, sll ? ntohs(sll->sll_protocol) : 0);
+}
+
+/* Handle the completions queued on the receive ring */
+static void rx_recv_cb(struct ev_loop *loop, ev_io *w, int revents)
+{
+	int count;
+
+	count = io_recv_run(g_rx_recv, false);
+	if (count < 0 && count != -EINTR)
+		warnx("io_uring receive failed: %s", strerror(-count));
+}
+
+/* Map the TPACKET_V3 receive ring onto the nlmon packet socket */
+static int nlmon_rx_ring_init(int sock, const struct nlmon_capture_config *cfg)
+{
+	struct tpacket_req3 req;
+	int version = TPACKET_V3;
+	unsigned int i;
+
+	if (setsockopt(sock, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+		warn("Failed to select TPACKET_V3");
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = cfg->ring_block_size;
+	req.tp_block_nr = cfg->ring_block_count;
+	req.tp_frame_size = NLMON_RX_RING_FRAME_SIZE;
+	req.tp_frame_nr = (req.tp_block_size / req.tp_frame_size) * req.tp_block_nr;
+	req.tp_retire_blk_tov = cfg->ring_block_timeout_ms;
+
+	if (setsockopt(sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		warn("Failed to set up PACKET_RX_RING");
+		return -1;
+	}
+
+	rx_ring.size = (size_t)req.tp_block_size * req.tp_block_nr;
+	rx_ring.map = mmap(NULL, rx_ring.size, PROT_READ | PROT_WRITE,
+	                   MAP_SHARED | MAP_POPULATE, sock, 0);
+	if (rx_ring.map == MAP_FAILED) {
+		warn("Failed to map nlmon receive ring");
+		rx_ring.map = NULL;
+		return -1;
+	}
+
+	rx_ring.blocks = calloc(req.tp_block_nr, sizeof(*rx_ring.blocks));
+	if (!rx_ring.blocks) {
+		munmap(rx_ring.map, rx_ring.size);
+		rx_ring.map = NULL;
+		return -1;
+	}
+
+	for (i = 0; i < req.tp_block_nr; i++)
+		rx_ring.blocks[i] = (struct tpacket_block_desc *)
+			(rx_ring.map + (size_t)i * req.tp_block_size);
+	rx_ring.block_count = req.tp_block_nr;
+	rx_ring.current = 0;
+
+	return 0;
+}
+
+static void nlmon_rx_ring_cleanup(void)
+{
+	if (rx_ring.map)
+		munmap(rx_ring.map, rx_ring.size);
+	free(rx_ring.blocks);
+	memset(&rx_ring, 0, sizeof(rx_ring));
+}
+
+/* Pull the kernel drop counters for the receive ring */
+static void nlmon_rx_ring_update_stats(void)
+{
+	struct tpacket_stats_v3 st;
+	socklen_t len = sizeof(st);
+
+	if (nlmon_sock < 0 || !rx_ring.map)
+		return;
+
+	/* Counters are reset on every read, so accumulate them */
+	if (getsockopt(nlmon_sock, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0) {
+		rx_stats.ring_drops += st.tp_drops;
+		rx_stats.ring_freezes += st.tp_freeze_q_cnt;
+	}
+}
+
+/* Walk retired ring blocks in place and hand the frames to the parser */
+static void nlmon_ring_cb(struct ev_loop *loop, ev_io *w, int revents)
+{
+	struct tpacket_block_desc *block;
+	struct tpacket3_hdr *ppd;
+	struct sockaddr_ll *sll;
+	uint32_t num_pkts, j;
+	unsigned int walked = 0;
+
+	rx_stats.wakeups++;
+
+	while (walked < rx_ring.block_count) {
+		block = rx_ring.blocks[rx_ring.current];
+		if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+		      TP_STATUS_USER))
+			break;
+
+		num_pkts = block->hdr.bh1.num_pkts;
+		ppd = (struct tpacket3_hdr *)((uint8_t *)block +
+		                              block->hdr.bh1.offset_to_first_pkt);
+		for (j = 0; j < num_pkts; j++) {
+			if (ppd->tp_snaplen < ppd->tp_len)
+				rx_stats.truncated++;
+			/* The link-layer address follows the frame header */
+			sll = (struct sockaddr_ll *)((uint8_t *)ppd +
+			                             TPACKET_ALIGN(sizeof(*ppd)));
+			nlmon_handle_packet((unsigned char *)ppd + ppd->tp_mac,
+			                    ppd->tp_snaplen, ntohs(sll->sll_protocol));
+			ppd = (struct tpacket3_hdr *)((uint8_t *)ppd + ppd->tp_next_offset);
+		}
+
+		rx_stats.batches++;
+		if (num_pkts > rx_stats.max_batch)
+			rx_stats.max_batch = num_pkts;
+
+		/* Give the block back to the kernel */
+		__atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL,
+		                 __ATOMIC_RELEASE);
+		rx_ring.current = (rx_ring.current + 1) % rx_ring.block_count;
+		walked++;
 	}
+
+	if (walked == rx_ring.block_count)
+		rx_stats.full_batches++;
 }
 
 /* Legacy cache-based callbacks - no longer used with new netlink manager
@@ -935,51 +2123,134 @@ static void nlnf_cb(struct ev_loop *loop, ev_io *w, int revents)
 	}
 }
 
-/* Removed old cache-based reconf iterator functions - no longer needed with new netlink manager */
+/* Managers of other namespaces decode and prefilter like our own */
+static int netns_manager_setup(struct nlmon_nl_manager *mgr, void *user_data)
+{
+	(void)user_data;
 
-static void refresh_cli_display(void)
+	nlmon_nl_set_lazy_decode(mgr, 1);
+	nlmon_filter_prefilter_manager(mgr);
+	return 0;
+}
+
+static void netns_sync(void)
 {
-	int i, start_idx, display_lines;
-	int row, col;
-	
-	if (!cli_mode || !main_win)
-		return;
-	
-	pthread_mutex_lock(&screen_mutex);
-	
-	/* Clear main window */
-	werase(main_win);
-	box(main_win, 0, 0);
-	mvwprintw(main_win, 0, 2, " Network Events ");
-	
-	/* Calculate how many lines we can display */
-	getmaxyx(main_win, row, col);
-	display_lines = row - 2; /* Account for border */
-	
-	/* Calculate starting index for scrolling */
-	start_idx = event_count - display_lines - event_scroll;
-	if (start_idx < 0)
-		start_idx = 0;
-	
-	/* Display events */
-	for (i = 0; i < display_lines && (start_idx + i) < event_count; i++) {
-		mvwprintw(main_win, i + 1, 2, "%.*s", col - 4, event_log[start_idx + i]);
-	}
-	
-	wrefresh(main_win);
-	
-	/* Update status window */
-	werase(status_win);
-	box(status_win, 0, 0);
-	mvwprintw(status_win, 0, 2, " Statistics ");
-	mvwprintw(status_win, 1, 2, "Links: %-8lu Routes: %-8lu Addrs: %-8lu Genl: %-8lu", 
-	          event_stats.link_events, event_stats.route_events, event_stats.addr_events,
+	int ret = nlmon_nl_netns_sync(g_netns_set, g_ns_tracker);
+
+	if (ret < 0)
+		warnx("Failed to sync network namespaces: %d", ret);
+}
+
+static void netns_io_cb(struct ev_loop *loop, ev_io *w, int revents)
+{
+	(void)loop;
+	(void)w;
+	(void)revents;
+
+	/* Ready sockets of all other namespaces, without blocking */
+	if (g_netns_set)
+		nlmon_nl_netns_process(g_netns_set, 0);
+}
+
+static void netns_watch_cb(struct ev_loop *loop, ev_io *w, int revents)
+{
+	(void)loop;
+	(void)w;
+	(void)revents;
+
+	/* A namespace was named or unnamed under /var/run/netns */
+	if (g_netns_set)
+		netns_sync();
+}
+
+static void netns_timer_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	(void)loop;
+	(void)w;
+	(void)revents;
+
+	g_timer_wakeups++;
+
+	/* Unnamed namespaces are only found by the tracker's rescans */
+	if (g_netns_set)
+		netns_sync();
+}
+
+/* Receive thread priority classes: control plane, default, bulk */
+static int rx_event_priority(const struct nlmon_event *evt, void *ctx)
+{
+	(void)ctx;
+
+	switch (evt->netlink.protocol) {
+	case NETLINK_ROUTE:
+		/* Link, route and neighbor changes feed security detection */
+		return 0;
+	case NETLINK_NETFILTER:
+		return 2;
+	case NETLINK_GENERIC:
+		/* nl80211 TRIGGER_SCAN and NEW_SCAN_RESULTS */
+		if (strcmp(evt->netlink.genl_family_name, "nl80211") == 0 &&
+		    (evt->netlink.genl_cmd == 33 || evt->netlink.genl_cmd == 34))
+			return 2;
+		break;
+	}
+
+	return -1;
+}
+
+/* Removed old cache-based reconf iterator functions - no longer needed with new netlink manager */
+
+#ifdef ENABLE_CLI
+static void refresh_cli_display(void)
+{
+	int i, start_idx, display_lines;
+	int row, col;
+	
+	if (!cli_mode || !main_win)
+		return;
+	
+	pthread_mutex_lock(&screen_mutex);
+	
+	/* Clear main window */
+	werase(main_win);
+	box(main_win, 0, 0);
+	mvwprintw(main_win, 0, 2, " Network Events ");
+	
+	/* Calculate how many lines we can display */
+	getmaxyx(main_win, row, col);
+	display_lines = row - 2; /* Account for border */
+	
+	/* Calculate starting index for scrolling */
+	start_idx = event_count - display_lines - event_scroll;
+	if (start_idx < 0)
+		start_idx = 0;
+	
+	/* Display events */
+	for (i = 0; i < display_lines && (start_idx + i) < event_count; i++) {
+		mvwprintw(main_win, i + 1, 2, "%.*s", col - 4, event_log[start_idx + i]);
+	}
+	
+	wrefresh(main_win);
+	
+	/* Update status window */
+	werase(status_win);
+	box(status_win, 0, 0);
+	mvwprintw(status_win, 0, 2, " Statistics ");
+	mvwprintw(status_win, 1, 2, "Links: %-8lu Routes: %-8lu Addrs: %-8lu Genl: %-8lu", 
+	          event_stats.link_events, event_stats.route_events, event_stats.addr_events,
 	          event_stats.generic_events);
 	mvwprintw(status_win, 2, 2, "Neigh: %-8lu Rules:  %-8lu Diag:  %-8lu Total: %-8lu",
 	          event_stats.neigh_events, event_stats.rule_events, event_stats.sock_diag_events,
 	          event_stats.link_events + event_stats.route_events + 
 	          event_stats.addr_events + event_stats.neigh_events + event_stats.rule_events +
 	          event_stats.generic_events + event_stats.sock_diag_events);
+	if (use_nlmon) {
+		nlmon_rx_ring_update_stats();
+		mvwprintw(status_win, 3, 2, "nlmon: Pkts: %-8lu Msgs: %-8lu Wakeups: %-8lu Batch: %.1f avg %u max  Drops: %lu",
+		          rx_stats.packets, rx_stats.messages, rx_stats.wakeups,
+		          rx_stats.batches ? (double)rx_stats.packets / rx_stats.batches : 0.0,
+		          rx_stats.max_batch, rx_stats.ring_drops);
+	}
 	wrefresh(status_win);
 	
 	/* Update command window */
@@ -1006,10 +2277,10 @@ static void init_cli(void)
 	getmaxyx(stdscr, max_y, max_x);
 	
 	/* Main event window */
-	main_win = newwin(max_y - 7, max_x, 0, 0);
+	main_win = newwin(max_y - 8, max_x, 0, 0);
 	
 	/* Status window */
-	status_win = newwin(4, max_x, max_y - 7, 0);
+	status_win = newwin(5, max_x, max_y - 8, 0);
 	
 	/* Command window */
 	cmd_win = newwin(3, max_x, max_y - 3, 0);
@@ -1027,30 +2298,29 @@ static void cleanup_cli(void)
 		delwin(cmd_win);
 	endwin();
 }
+#endif /* ENABLE_CLI */
 
 /* Cleanup memory management and resource tracking */
 static void cleanup_memory_management(void)
 {
+	/* Lazy phases still starting finish first */
+	startup_graph_destroy(g_startup);
+	g_startup = NULL;
+	
+#ifdef ENABLE_QCA
 	/* Cleanup QCA control integration */
-	if (enable_qca_control) {
+	if (atomic_load(&g_qca_ready)) {
 		qca_nlmon_cleanup();
 	}
+	qca_stats_poller_destroy(g_stats_poller);
+	g_stats_poller = NULL;
 	
 	/* Cleanup WMI monitoring */
 	if (enable_wmi) {
-		if (wmi_thread_started) {
-			/* Stop WMI reader */
-			wmi_log_reader_stop();
-			
-			/* Wait for thread to finish */
-			pthread_join(wmi_thread, NULL);
-			wmi_thread_started = 0;
-		}
-		
-		/* Cleanup WMI components */
-		wmi_log_reader_cleanup();
+		wmi_sources_stop();
 		wmi_bridge_cleanup();
 	}
+#endif
 	
 	/* Dump memory statistics if tracker is enabled */
 	if (g_memory_tracker) {
@@ -1086,192 +2356,913 @@ static void cleanup_memory_management(void)
 	
 	/* Cleanup multi-protocol context */
 	if (g_multi_proto_ctx) {
+		static const struct {
+			nlmon_protocol_t proto;
+			const char *name;
+		} protos[] = {
+			{ NLMON_PROTO_GENERIC, "NETLINK_GENERIC" },
+			{ NLMON_PROTO_SOCK_DIAG, "NETLINK_SOCK_DIAG" },
+		};
+		
+		for (size_t i = 0; verbose_mode && i < sizeof(protos) / sizeof(protos[0]); i++) {
+			struct nlmon_multi_protocol_stats ms;
+			char msg[256];
+			
+			if (nlmon_multi_protocol_get_fd(g_multi_proto_ctx, protos[i].proto) < 0 ||
+			    nlmon_multi_protocol_get_stats(g_multi_proto_ctx, protos[i].proto, &ms) < 0)
+				continue;
+			snprintf(msg, sizeof(msg),
+			         "%s dispatch: %lu msgs in %lu datagrams, %lu drains (%lu us), %lu over budget, backlog %u bytes",
+			         protos[i].name, (unsigned long)ms.messages, (unsigned long)ms.datagrams,
+			         (unsigned long)ms.drains, (unsigned long)(ms.drain_ns / 1000),
+			         (unsigned long)ms.budget_exhausted, ms.backlog);
+			log_event(msg);
+		}
 		nlmon_multi_protocol_destroy(g_multi_proto_ctx);
 		g_multi_proto_ctx = NULL;
 	}
 }
 
-static void show_help(void)
+#ifdef ENABLE_CLI
+static void show_help(void)
+{
+	WINDOW *help_win;
+	int max_y, max_x;
+	
+	getmaxyx(stdscr, max_y, max_x);
+	help_win = newwin(max_y - 4, max_x - 4, 2, 2);
+	
+	box(help_win, 0, 0);
+	mvwprintw(help_win, 0, 2, " Help ");
+	mvwprintw(help_win, 2, 4, "nlmon - Network Link Monitor");
+	mvwprintw(help_win, 3, 4, "============================");
+	mvwprintw(help_win, 5, 4, "Keys:");
+	mvwprintw(help_win, 6, 6, "q       - Quit application");
+	mvwprintw(help_win, 7, 6, "h       - Show this help");
+	mvwprintw(help_win, 8, 6, "c       - Clear event log");
+	mvwprintw(help_win, 9, 6, "UP      - Scroll up");
+	mvwprintw(help_win, 10, 6, "DOWN    - Scroll down");
+	mvwprintw(help_win, 11, 6, "a       - Toggle address monitoring");
+	mvwprintw(help_win, 12, 6, "n       - Toggle neighbor monitoring");
+	mvwprintw(help_win, 13, 6, "r       - Toggle rules monitoring");
+	mvwprintw(help_win, 15, 4, "Monitoring:");
+	mvwprintw(help_win, 16, 6, "- Link changes (interfaces up/down)");
+	mvwprintw(help_win, 17, 6, "- Route changes (default route)");
+	mvwprintw(help_win, 18, 6, "- Address changes (IP addresses)");
+	mvwprintw(help_win, 19, 6, "- Neighbor changes (ARP table)");
+	mvwprintw(help_win, 20, 6, "- Rule changes (routing rules)");
+	mvwprintw(help_win, 22, 4, "Press any key to close...");
+	
+	wrefresh(help_win);
+	nodelay(stdscr, FALSE);
+	getch();
+	nodelay(stdscr, TRUE);
+	delwin(help_win);
+	refresh_cli_display();
+}
+
+static void handle_cli_input(void)
+{
+	int ch;
+	char msg[256];
+	
+	if (!cli_mode)
+		return;
+	
+	ch = getch();
+	if (ch == ERR)
+		return;
+	
+	switch (ch) {
+	case 'q':
+	case 'Q':
+		cleanup_cli();
+		/* Cleanup netlink manager */
+		if (g_nl_manager) {
+			nlmon_nl_manager_destroy(g_nl_manager);
+			g_nl_manager = NULL;
+		}
+		/* Cleanup nlmon resources */
+		if (nlmon_sock >= 0)
+			close(nlmon_sock);
+		if (pcap_fp)
+			fclose(pcap_fp);
+		cleanup_memory_management();
+		exit(0);
+		break;
+	case 'h':
+	case 'H':
+		show_help();
+		break;
+	case 'c':
+	case 'C':
+		pthread_mutex_lock(&screen_mutex);
+		event_count = 0;
+		event_scroll = 0;
+		pthread_mutex_unlock(&screen_mutex);
+		refresh_cli_display();
+		break;
+	case KEY_UP:
+		if (event_scroll < event_count - 1)
+			event_scroll++;
+		refresh_cli_display();
+		break;
+	case KEY_DOWN:
+		if (event_scroll > 0)
+			event_scroll--;
+		refresh_cli_display();
+		break;
+	case 'a':
+	case 'A':
+		monitor_addr = !monitor_addr;
+		snprintf(msg, sizeof(msg), "Address monitoring %s", monitor_addr ? "enabled" : "disabled");
+		log_event(msg);
+		refresh_cli_display();
+		break;
+	case 'n':
+	case 'N':
+		monitor_neigh = !monitor_neigh;
+		snprintf(msg, sizeof(msg), "Neighbor monitoring %s", monitor_neigh ? "enabled" : "disabled");
+		log_event(msg);
+		refresh_cli_display();
+		break;
+	case 'r':
+	case 'R':
+		monitor_rules = !monitor_rules;
+		snprintf(msg, sizeof(msg), "Rules monitoring %s", monitor_rules ? "enabled" : "disabled");
+		log_event(msg);
+		refresh_cli_display();
+		break;
+	}
+}
+
+static void cli_update_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	g_timer_wakeups++;
+	refresh_cli_display();
+	handle_cli_input();
+}
+#endif /* ENABLE_CLI */
+
+/* reconf */
+static void sighub_cb(struct ev_loop *loop, ev_signal *w, int revents)
+{
+	(void)loop;
+	(void)w;
+	(void)revents;
+	
+	if (verbose_mode) {
+		log_event("SIGHUP received");
+	}
+	
+#ifdef ENABLE_CONFIG
+	/* Reload off the loop, events keep using the old snapshot until the
+	 * new one is parsed, validated and its filters compiled; embedded
+	 * mode has no thread to spare and reloads on the loop */
+	if (!g_config_loaded || atomic_exchange(&g_reload_running, true))
+		return;
+	if (embedded_mode) {
+		config_reload_thread(NULL);
+		return;
+	}
+	if (g_reload_started)
+		pthread_join(g_reload_thread, NULL);
+	g_reload_started = pthread_create(&g_reload_thread, NULL,
+	                                  config_reload_thread, NULL) == 0;
+	if (!g_reload_started) {
+		warnx("Failed to start configuration reload");
+		atomic_store(&g_reload_running, false);
+	}
+#endif
+}
+
+/* A pipeline thread stopped making progress (core.watchdog) */
+static void pipeline_stall_cb(const struct nlmon_stall *stall, void *ctx)
+{
+	char msg[256];
+	
+	(void)ctx;
+	snprintf(msg, sizeof(msg), "watchdog: %s (tid %d) stalled in %s for %llu ms%s",
+	         stall->name, (int)stall->tid, stall->stage,
+	         (unsigned long long)stall->stalled_ms,
+	         stall->restarted ? ", restarted" : "");
+	warnx("%s", msg);
+	log_event(msg);
+	if (stall->stack)
+		fprintf(stderr, "%s", stall->stack);
+}
+
+static void sigint_cb(struct ev_loop *loop, ev_signal *w, int revents)
+{
+#ifdef ENABLE_CLI
+	if (cli_mode)
+		cleanup_cli();
+#endif
+	ev_unloop(loop, EVUNLOOP_ALL);
+}
+
+/* Stats bus snapshots in embedded mode, in place of the bus thread */
+static void stats_bus_timer_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	(void)loop;
+	(void)w;
+	(void)revents;
+	
+	g_timer_wakeups++;
+	stats_bus_publish(g_stats_bus);
+}
+
+#ifdef ENABLE_CONFIG
+/* Pipeline watchdog scans in embedded mode, in place of its thread */
+static void watchdog_timer_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	(void)loop;
+	(void)w;
+	(void)revents;
+	
+	g_timer_wakeups++;
+	nlmon_watchdog_check(&g_watchdog_config);
+}
+#endif
+
+/* Log the resident set and the loop wakeups since the last report */
+static void embedded_report(struct ev_loop *loop)
+{
+	static unsigned int last_iterations;
+	static unsigned long last_timer_wakeups;
+	unsigned int iterations = ev_iteration(loop);
+	ev_tstamp now = ev_now(loop);
+	struct rusage usage;
+	char msg[192];
+	
+	if (getrusage(RUSAGE_SELF, &usage) < 0)
+		usage.ru_maxrss = 0;
+	
+	snprintf(msg, sizeof(msg),
+	         "Embedded: RSS %zu kB (peak %ld kB), %u wakeups in %.0f s, %lu of them by timers",
+	         memory_governor_process_rss() / 1024, usage.ru_maxrss,
+	         iterations - last_iterations, now - g_report_time,
+	         g_timer_wakeups - last_timer_wakeups);
+	log_event(msg);
+	
+	last_iterations = iterations;
+	last_timer_wakeups = g_timer_wakeups;
+	g_report_time = now;
+}
+
+static void embedded_report_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	(void)w;
+	(void)revents;
+	
+	g_timer_wakeups++;
+	embedded_report(loop);
+}
+
+static int init(struct context *ctx)
+{
+	(void)ctx;  /* Context no longer used with new netlink manager */
+
+	/* 
+	 * With the new nlmon_nl_manager, we don't use caches.
+	 * Messages are processed directly via callbacks set up in the manager.
+	 * The old cache-based approach has been replaced with direct message processing.
+	 */
+
+	if (verbose_mode) {
+		log_event("Netlink manager initialized successfully");
+	}
+
+	return 0;
+}
+
+/* Startup phases, run by nlmon_startup() */
+
+/* Zero-downtime upgrade (-H) */
+
+static const struct {
+	unsigned int role;
+	int protocol;
+	int (*get_fd)(struct nlmon_nl_manager *mgr);
+} upgrade_nl_sockets[] = {
+	{ NLMON_UPGRADE_FD_NL_ROUTE,     NETLINK_ROUTE,     nlmon_nl_get_route_fd },
+	{ NLMON_UPGRADE_FD_NL_GENERIC,   NETLINK_GENERIC,   nlmon_nl_get_genl_fd },
+	{ NLMON_UPGRADE_FD_NL_DIAG,      NETLINK_SOCK_DIAG, nlmon_nl_get_diag_fd },
+	{ NLMON_UPGRADE_FD_NL_NETFILTER, NETLINK_NETFILTER, nlmon_nl_get_nf_fd },
+};
+
+/* Ask a running instance for its sockets, 0 if there is none to take over */
+static int upgrade_takeover(void)
+{
+	int conn, err;
+	
+	conn = nlmon_upgrade_connect(upgrade_path);
+	if (conn == -ENOENT || conn == -ECONNREFUSED)
+		return 0;
+	if (conn < 0)
+		return conn;
+	
+	err = nlmon_upgrade_request(conn);
+	if (err == 0)
+		err = nlmon_upgrade_recv(conn, &g_upgrade);
+	if (err < 0) {
+		close(conn);
+		return err;
+	}
+	
+	g_upgrade_conn = conn;
+	return 1;
+}
+
+/* String section of the predecessor, NULL if absent or malformed */
+static char *upgrade_string(uint32_t type)
+{
+	const char *str;
+	size_t len;
+	
+	str = nlmon_upgrade_get_section(g_upgrade, type, &len);
+	if (!str || !len || str[len - 1] != '\0')
+		return NULL;
+	return strdup(str);
+}
+
+/* What the predecessor was running with, unless given again */
+static void upgrade_restore_state(void)
+{
+	const char (*lines)[sizeof(event_log[0])];
+	size_t count;
+	
+	if (!filter_expression && filter_msg_type < 0)
+		filter_expression = upgrade_string(NLMON_UPGRADE_SEC_FILTER);
+#ifdef ENABLE_CONFIG
+	if (!config_file)
+		config_file = upgrade_string(NLMON_UPGRADE_SEC_CONFIG);
+#endif
+	
+	lines = nlmon_upgrade_get_records(g_upgrade, NLMON_UPGRADE_SEC_EVENT_LOG,
+	                                  sizeof(event_log[0]), &count);
+	if (count > MAX_EVENTS) {
+		lines += count - MAX_EVENTS;
+		count = MAX_EVENTS;
+	}
+	for (size_t i = 0; i < count; i++)
+		snprintf(event_log[i], sizeof(event_log[0]), "%.*s",
+		         (int)sizeof(event_log[0]) - 1, lines[i]);
+	event_count = (int)count;
+}
+
+/* Hand the predecessor's netlink sockets to the manager */
+static void upgrade_adopt_sockets(struct nlmon_nl_manager *mgr)
+{
+	size_t i;
+	int fd;
+	
+	for (i = 0; i < sizeof(upgrade_nl_sockets) / sizeof(upgrade_nl_sockets[0]); i++) {
+		fd = nlmon_upgrade_take_fd(g_upgrade, upgrade_nl_sockets[i].role);
+		if (fd >= 0 && nlmon_nl_adopt_socket(mgr, upgrade_nl_sockets[i].protocol, fd) < 0)
+			close(fd);
+	}
+}
+
+/* Tell the predecessor whether to exit (0) or to resume */
+static int upgrade_complete(int status)
+{
+	int err;
+	
+	if (g_upgrade_conn < 0)
+		return 0;
+	
+	err = nlmon_upgrade_done(g_upgrade_conn, status);
+	close(g_upgrade_conn);
+	g_upgrade_conn = -1;
+	nlmon_upgrade_destroy(g_upgrade);
+	g_upgrade = NULL;
+	
+	return err;
+}
+
+/* Stop receiving, what arrives from here on is queued for the successor */
+static void upgrade_pause_receive(void)
+{
+	if (g_rx_processor)
+		nlmon_nl_stop_rx_threads(g_nl_manager);
+	if (g_rx_recv) {
+		/* Handle what was received, then cancel the receives */
+		io_recv_run(g_rx_recv, false);
+		nlmon_nl_detach_io_recv(g_nl_manager);
+		if (rx_recv_nlmon_source >= 0)
+			io_recv_set_fd(g_rx_recv, rx_recv_nlmon_source, -1);
+	}
+}
+
+static void upgrade_resume_receive(void)
+{
+	int err;
+	
+	if (g_rx_processor) {
+		err = use_rx_uring ? nlmon_nl_start_rx_uring(g_nl_manager, g_rx_processor,
+		                                             rx_threads_cpu) : -EOPNOTSUPP;
+		if (err < 0)
+			err = nlmon_nl_start_rx_threads(g_nl_manager, g_rx_processor, rx_threads_cpu);
+		if (err < 0)
+			warnx("Failed to restart netlink receive threads: %d", err);
+	}
+	if (g_rx_recv) {
+		if (nlmon_nl_attach_io_recv(g_nl_manager, g_rx_recv) < 0)
+			warnx("Failed to receive netlink sockets through io_uring again");
+		if (rx_recv_nlmon_source >= 0)
+			io_recv_set_fd(g_rx_recv, rx_recv_nlmon_source, nlmon_sock);
+		io_recv_run(g_rx_recv, false);
+	}
+}
+
+/* Sockets and state for the successor */
+static int upgrade_save(struct nlmon_upgrade *up)
+{
+	char type_filter[64];
+	size_t i;
+	int err = 0, fd;
+	
+	for (i = 0; i < sizeof(upgrade_nl_sockets) / sizeof(upgrade_nl_sockets[0]); i++) {
+		fd = upgrade_nl_sockets[i].get_fd(g_nl_manager);
+		if (fd >= 0 && err == 0)
+			err = nlmon_upgrade_add_fd(up, upgrade_nl_sockets[i].role, fd);
+	}
+	
+	/* A mapped capture ring stays with its process, the successor binds anew */
+	if (nlmon_sock >= 0 && !rx_ring.map && err == 0)
+		err = nlmon_upgrade_add_fd(up, NLMON_UPGRADE_FD_CAPTURE, nlmon_sock);
+	
+	if (filter_expression && err == 0) {
+		err = nlmon_upgrade_add_section(up, NLMON_UPGRADE_SEC_FILTER, filter_expression,
+		                                strlen(filter_expression) + 1);
+	} else if (filter_msg_type >= 0 && err == 0) {
+		snprintf(type_filter, sizeof(type_filter), "netlink.msg_type == %d", filter_msg_type);
+		err = nlmon_upgrade_add_section(up, NLMON_UPGRADE_SEC_FILTER, type_filter,
+		                                strlen(type_filter) + 1);
+	}
+#ifdef ENABLE_CONFIG
+	if (config_file && err == 0)
+		err = nlmon_upgrade_add_section(up, NLMON_UPGRADE_SEC_CONFIG, config_file,
+		                                strlen(config_file) + 1);
+#endif
+	
+	if (err == 0) {
+		pthread_mutex_lock(&screen_mutex);
+		err = nlmon_upgrade_add_records(up, NLMON_UPGRADE_SEC_EVENT_LOG, event_log,
+		                                sizeof(event_log[0]), event_count);
+		pthread_mutex_unlock(&screen_mutex);
+	}
+	
+	return err;
+}
+
+/* Hand everything over to the process on @conn, 0 once it took over */
+static int upgrade_handoff(int conn)
+{
+	struct nlmon_upgrade *up;
+	int err;
+	
+	err = nlmon_upgrade_wait_request(conn);
+	if (err < 0)
+		return err;
+	
+	upgrade_pause_receive();
+	
+	up = nlmon_upgrade_create();
+	err = up ? upgrade_save(up) : -ENOMEM;
+	if (err == 0)
+		err = nlmon_upgrade_send(conn, up);
+	if (err == 0)
+		err = nlmon_upgrade_wait_done(conn);
+	nlmon_upgrade_destroy(up);
+	
+	if (err != 0)
+		upgrade_resume_receive();
+	return err;
+}
+
+static void upgrade_cb(struct ev_loop *loop, ev_io *w, int revents)
+{
+	char msg[128];
+	int conn, err;
+	
+	(void)revents;
+	
+	conn = nlmon_upgrade_accept(w->fd);
+	if (conn < 0)
+		return;
+	
+	/* The main loop reads nothing until this returns */
+	err = upgrade_handoff(conn);
+	close(conn);
+	if (err != 0) {
+		snprintf(msg, sizeof(msg), "Upgrade handoff failed (%d), resuming", err);
+		log_event(msg);
+		return;
+	}
+	
+	log_event("Handed over to the new process, exiting");
+	upgrade_handed_over = 1;
+	ev_break(loop, EVBREAK_ALL);
+}
+
+static int startup_netlink(void *arg)
+{
+	int err;
+	
+	(void)arg;
+	
+	g_nl_manager = nlmon_nl_manager_init();
+	if (!g_nl_manager) {
+		warnx("Failed to initialize netlink manager");
+		return -ENOMEM;
+	}
+
+	/* Set event callback for netlink manager */
+	nlmon_nl_set_callback(g_nl_manager, netlink_manager_event_cb, NULL);
+	
+	/* The sockets of the process taken over, events queued on them included */
+	if (g_upgrade)
+		upgrade_adopt_sockets(g_nl_manager);
+	
+	/* Route attributes are only decoded for events that pass the filter */
+	nlmon_nl_set_lazy_decode(g_nl_manager, 1);
+	
+	/* Attached to each protocol's socket as it is enabled */
+	nlmon_filter_prefilter_manager(g_nl_manager);
+
+	/* Enable NETLINK_ROUTE protocol (always enabled) */
+	err = nlmon_nl_enable_route(g_nl_manager);
+	if (err < 0) {
+		warnx("Failed to enable NETLINK_ROUTE: %d", err);
+		return err;
+	}
+
+	/* Enable NETLINK_GENERIC if requested */
+	if (show_generic_netlink || show_all_protocols) {
+		err = nlmon_nl_enable_generic(g_nl_manager);
+		if (err < 0) {
+			warnx("Failed to enable NETLINK_GENERIC: %d", err);
+			/* Non-fatal - continue without generic netlink */
+		} else if (verbose_mode) {
+			log_event("NETLINK_GENERIC enabled via netlink manager");
+		}
+	}
+
+	/* Enable NETLINK_SOCK_DIAG if requested */
+	if (show_all_protocols) {
+		err = nlmon_nl_enable_diag(g_nl_manager);
+		if (err < 0) {
+			warnx("Failed to enable NETLINK_SOCK_DIAG: %d", err);
+			/* Non-fatal - continue without socket diagnostics */
+		} else if (verbose_mode) {
+			log_event("NETLINK_SOCK_DIAG enabled via netlink manager");
+		}
+	}
+
+	/* Enable NETLINK_NETFILTER if requested */
+	if (show_all_protocols) {
+#ifdef ENABLE_CONFIG
+		/* Join only the configured conntrack groups */
+		if (g_config_loaded) {
+			struct nlmon_netlink_config nl_cfg;
+			
+			nlmon_config_get_netlink(&g_config_ctx, &nl_cfg);
+			err = nlmon_nl_apply_ct_config(g_nl_manager, &nl_cfg);
+			if (err < 0)
+				warnx("Failed to set conntrack filter: %d", err);
+		}
+#endif
+		err = nlmon_nl_enable_netfilter(g_nl_manager);
+		if (err < 0) {
+			warnx("Failed to enable NETLINK_NETFILTER: %d", err);
+			/* Non-fatal - continue without netfilter */
+		} else if (verbose_mode) {
+			log_event("NETLINK_NETFILTER enabled via netlink manager");
+		}
+	}
+
+	/* Recover from receive buffer overruns with a state diff, not a restart */
+	g_nl_limits = nlmon_nl_limits_create();
+	if (g_nl_limits) {
+		struct nlmon_nl_autotune_config autotune = {
+			.enabled = true,
+			.max_rcvbuf = 8 * 1024 * 1024,
+		};
+		
+		/* Rate limiting is the event processor's job, only account here */
+		nlmon_nl_limits_enable_rate(g_nl_limits, false);
+		nlmon_nl_limits_enable_memory(g_nl_limits, false);
+#ifdef ENABLE_CONFIG
+		if (g_config_loaded) {
+			struct nlmon_netlink_config nl_cfg;
+			
+			nlmon_config_get_netlink(&g_config_ctx, &nl_cfg);
+			autotune.enabled = nl_cfg.buffer_size.autotune;
+			autotune.min_rcvbuf = nl_cfg.buffer_size.receive;
+			autotune.max_rcvbuf = nl_cfg.buffer_size.receive_max;
+		}
+#endif
+		nlmon_nl_limits_set_autotune(g_nl_limits, &autotune);
+	}
+	nlmon_nl_set_limits(g_nl_manager, g_nl_limits);
+	err = nlmon_nl_enable_resync(g_nl_manager);
+	if (err < 0) {
+		warnx("Failed to enable netlink overrun resync: %d", err);
+		/* Non-fatal - overruns will just lose events */
+	} else if (verbose_mode) {
+		log_event("NETLINK_ROUTE overrun resync enabled");
+	}
+	
+	return 0;
+}
+
+static int startup_multi_proto(void *arg)
+{
+	(void)arg;
+	
+	if (show_generic_netlink || show_all_protocols) {
+		g_multi_proto_ctx = nlmon_multi_protocol_init();
+		if (!g_multi_proto_ctx) {
+			warnx("Failed to initialize multi-protocol support");
+		} else {
+			nlmon_multi_protocol_set_callback(g_multi_proto_ctx, genetlink_event_cb, NULL);
+#ifdef ENABLE_CONFIG
+			if (g_config_loaded) {
+				struct nlmon_netlink_config nl_cfg;
+				
+				nlmon_config_get_netlink(&g_config_ctx, &nl_cfg);
+				nlmon_multi_protocol_set_budget(g_multi_proto_ctx, nl_cfg.dispatch.budget);
+				nlmon_multi_protocol_set_weight(g_multi_proto_ctx, NLMON_PROTO_ROUTE,
+				                                nl_cfg.dispatch.route_weight);
+				nlmon_multi_protocol_set_weight(g_multi_proto_ctx, NLMON_PROTO_GENERIC,
+				                                nl_cfg.dispatch.generic_weight);
+				nlmon_multi_protocol_set_weight(g_multi_proto_ctx, NLMON_PROTO_SOCK_DIAG,
+				                                nl_cfg.dispatch.sock_diag_weight);
+			}
+#endif
+			
+			if (show_generic_netlink || show_all_protocols) {
+				if (nlmon_multi_protocol_enable(g_multi_proto_ctx, NLMON_PROTO_GENERIC) == 0) {
+					if (verbose_mode)
+						log_event("NETLINK_GENERIC monitoring enabled");
+				} else {
+					warnx("Failed to enable NETLINK_GENERIC monitoring");
+				}
+			}
+			
+			if (show_all_protocols) {
+				if (nlmon_multi_protocol_enable(g_multi_proto_ctx, NLMON_PROTO_SOCK_DIAG) == 0) {
+					if (verbose_mode)
+						log_event("NETLINK_SOCK_DIAG monitoring enabled");
+				} else {
+					warnx("Failed to enable NETLINK_SOCK_DIAG monitoring");
+				}
+			}
+		}
+	}
+	
+	return g_multi_proto_ctx ? 0 : -1;
+}
+
+#ifdef ENABLE_QCA
+static int startup_wmi(void *arg)
 {
-	WINDOW *help_win;
-	int max_y, max_x;
-	
-	getmaxyx(stdscr, max_y, max_x);
-	help_win = newwin(max_y - 4, max_x - 4, 2, 2);
+	(void)arg;
 	
-	box(help_win, 0, 0);
-	mvwprintw(help_win, 0, 2, " Help ");
-	mvwprintw(help_win, 2, 4, "nlmon - Network Link Monitor");
-	mvwprintw(help_win, 3, 4, "============================");
-	mvwprintw(help_win, 5, 4, "Keys:");
-	mvwprintw(help_win, 6, 6, "q       - Quit application");
-	mvwprintw(help_win, 7, 6, "h       - Show this help");
-	mvwprintw(help_win, 8, 6, "c       - Clear event log");
-	mvwprintw(help_win, 9, 6, "UP      - Scroll up");
-	mvwprintw(help_win, 10, 6, "DOWN    - Scroll down");
-	mvwprintw(help_win, 11, 6, "a       - Toggle address monitoring");
-	mvwprintw(help_win, 12, 6, "n       - Toggle neighbor monitoring");
-	mvwprintw(help_win, 13, 6, "r       - Toggle rules monitoring");
-	mvwprintw(help_win, 15, 4, "Monitoring:");
-	mvwprintw(help_win, 16, 6, "- Link changes (interfaces up/down)");
-	mvwprintw(help_win, 17, 6, "- Route changes (default route)");
-	mvwprintw(help_win, 18, 6, "- Address changes (IP addresses)");
-	mvwprintw(help_win, 19, 6, "- Neighbor changes (ARP table)");
-	mvwprintw(help_win, 20, 6, "- Rule changes (routing rules)");
-	mvwprintw(help_win, 22, 4, "Press any key to close...");
+	if (enable_wmi) {
+		struct wmi_bridge_config bridge_config;
+		
+		/* Initialize WMI event bridge first */
+		memset(&bridge_config, 0, sizeof(bridge_config));
+		bridge_config.event_processor = NULL;  /* Not using event processor for now */
+		bridge_config.verbose = verbose_mode;
+		bridge_config.user_data = NULL;
+		
+		if (wmi_bridge_init(&bridge_config) < 0) {
+			warnx("Failed to initialize WMI event bridge");
+			enable_wmi = 0;
+		} else {
+			int i, failed = 0;
+			
+			/* Configure a WMI log reader per source, replay reads by itself
+			 * except in embedded mode, where it reads the file in order on
+			 * the loop */
+			for (i = 0; i < wmi_source_count && (!wmi_replay_mode || embedded_mode) &&
+			     !failed; i++) {
+				struct wmi_source *source = &wmi_sources[i];
+				struct wmi_log_config wmi_config;
+				
+				memset(&wmi_config, 0, sizeof(wmi_config));
+				wmi_config.log_source = source->path;
+				wmi_config.follow_mode = source->follow_mode;
+				wmi_config.buffer_size = 4096;
+				wmi_config.callback = wmi_log_line_cb;
+				wmi_config.user_data = source;
+				
+				source->reader = wmi_log_reader_create(&wmi_config);
+				if (!source->reader) {
+					warnx("Failed to initialize WMI log reader: %s", source->path);
+					failed = 1;
+				}
+			}
+			
+			/* Start a WMI reader thread per source, embedded mode reads
+			 * them from the loop, see wmi_sources_watch() */
+			for (i = 0; i < wmi_source_count && !failed; i++) {
+				struct wmi_source *source = &wmi_sources[i];
+				
+				if (verbose_mode) {
+					char msg[256];
+					snprintf(msg, sizeof(msg), "WMI monitoring enabled: source=%s%s",
+					         source->follow_mode ? "follow:" :
+					         wmi_replay_mode ? "replay:" : "",
+					         source->path);
+					log_event(msg);
+				}
+				
+				if (embedded_mode)
+					continue;
+				if (pthread_create(&source->thread, NULL, wmi_reader_thread, source) != 0) {
+					warn("Failed to create WMI reader thread");
+					failed = 1;
+					break;
+				}
+				thread_affinity_apply(source->thread, threads_cfg.wmi_cpus,
+				                      -1, "wmi-reader");
+				source->thread_started = 1;
+			}
+			
+			if (failed) {
+				wmi_sources_stop();
+				wmi_bridge_cleanup();
+				enable_wmi = 0;
+			}
+		}
+	}
 	
-	wrefresh(help_win);
-	nodelay(stdscr, FALSE);
-	getch();
-	nodelay(stdscr, TRUE);
-	delwin(help_win);
-	refresh_cli_display();
+	return enable_wmi ? 0 : -1;
 }
 
-static void handle_cli_input(void)
+/* Started on the first nl80211 event, see qca_control_ready() */
+static int startup_qca(void *arg)
 {
-	int ch;
-	char msg[256];
-	
-	if (!cli_mode)
-		return;
+	(void)arg;
 	
-	ch = getch();
-	if (ch == ERR)
-		return;
+	if (qca_nlmon_init(qca_interface, verbose_mode) < 0) {
+		warnx("Failed to initialize QCA driver control");
+		return -1;
+	}
 	
-	switch (ch) {
-	case 'q':
-	case 'Q':
-		cleanup_cli();
-		/* Cleanup netlink manager */
-		if (g_nl_manager) {
-			nlmon_nl_manager_destroy(g_nl_manager);
-			g_nl_manager = NULL;
+		if (verbose_mode) {
+			char msg[256];
+			snprintf(msg, sizeof(msg), "QCA driver control enabled for %s", qca_interface);
+			log_event(msg);
 		}
-		/* Cleanup nlmon resources */
-		if (nlmon_sock >= 0)
-			close(nlmon_sock);
-		if (pcap_fp)
-			fclose(pcap_fp);
-		cleanup_memory_management();
-		exit(0);
-		break;
-	case 'h':
-	case 'H':
-		show_help();
-		break;
-	case 'c':
-	case 'C':
-		pthread_mutex_lock(&screen_mutex);
-		event_count = 0;
-		event_scroll = 0;
-		pthread_mutex_unlock(&screen_mutex);
-		refresh_cli_display();
-		break;
-	case KEY_UP:
-		if (event_scroll < event_count - 1)
-			event_scroll++;
-		refresh_cli_display();
-		break;
-	case KEY_DOWN:
-		if (event_scroll > 0)
-			event_scroll--;
-		refresh_cli_display();
-		break;
-	case 'a':
-	case 'A':
-		monitor_addr = !monitor_addr;
-		snprintf(msg, sizeof(msg), "Address monitoring %s", monitor_addr ? "enabled" : "disabled");
-		log_event(msg);
-		refresh_cli_display();
-		break;
-	case 'n':
-	case 'N':
-		monitor_neigh = !monitor_neigh;
-		snprintf(msg, sizeof(msg), "Neighbor monitoring %s", monitor_neigh ? "enabled" : "disabled");
-		log_event(msg);
-		refresh_cli_display();
-		break;
-	case 'r':
-	case 'R':
-		monitor_rules = !monitor_rules;
-		snprintf(msg, sizeof(msg), "Rules monitoring %s", monitor_rules ? "enabled" : "disabled");
-		log_event(msg);
-		refresh_cli_display();
-		break;
-	}
-}
-
-static void cli_update_cb(struct ev_loop *loop, ev_timer *w, int revents)
-{
-	refresh_cli_display();
-	handle_cli_input();
+		
+		/* Configure auto roaming if enabled */
+		if (qca_auto_roaming) {
+			qca_nlmon_enable_auto_roaming(1);
+			qca_nlmon_set_roaming_thresholds(75, 70, 65);
+			if (verbose_mode) {
+				log_event("Auto roaming adjustment enabled");
+			}
+		}
+		
+		/* Configure stats collection if enabled */
+		if (qca_stats_on_roam) {
+			qca_nlmon_enable_stats_on_roam(1);
+			if (verbose_mode) {
+				log_event("Stats collection on roam enabled");
+			}
+		}
+	
+	atomic_store(&g_qca_ready, true);
+	return 0;
 }
+#endif /* ENABLE_QCA */
 
-/* reconf */
-static void sighub_cb(struct ev_loop *loop, ev_signal *w, int revents)
+static int startup_netns(void *arg)
 {
-	(void)loop;
-	(void)w;
-	(void)revents;
-
-	/* 
-	 * With the new netlink manager, we don't use caches.
-	 * SIGHUP could be used to reload configuration in the future.
-	 */
-	if (verbose_mode) {
-		log_event("SIGHUP received");
+	struct nlmon_nl_netns_config netns_config = {
+		.enable_route = 1,
+		.enable_genl = show_generic_netlink || show_all_protocols,
+		.enable_diag = show_all_protocols,
+		.enable_netfilter = show_all_protocols,
+		.event_callback = netlink_manager_event_cb,
+		.setup = netns_manager_setup,
+	};
+	
+	(void)arg;
+	
+	g_ns_tracker = namespace_tracker_init();
+	g_netns_set = g_ns_tracker ? nlmon_nl_netns_create(&netns_config) : NULL;
+	if (!g_netns_set) {
+		warnx("Failed to set up network namespace monitoring");
+		namespace_tracker_destroy(g_ns_tracker);
+		g_ns_tracker = NULL;
+		return -1;
 	}
+	
+	/* Entering every namespace is the slow part of a restart */
+	netns_sync();
+	return 0;
 }
 
-static void sigint_cb(struct ev_loop *loop, ev_signal *w, int revents)
+static int startup_add(const char *name, startup_fn fn, unsigned int flags, int dep)
 {
-	if (cli_mode)
-		cleanup_cli();
-	ev_unloop(loop, EVUNLOOP_ALL);
+	int phase = startup_graph_add(g_startup, name, fn, NULL, flags);
+	
+	if (phase >= 0 && dep >= 0)
+		startup_graph_depend(g_startup, phase, dep);
+	return phase;
 }
 
-static int init(struct context *ctx)
+/*
+ * Bring the subsystems up. Netlink ingestion comes first, its sockets
+ * queue events in the kernel (and overruns are resynced) while the rest
+ * starts in parallel behind it, so nothing waits for the slowest one.
+ */
+static int nlmon_startup(void)
 {
-	(void)ctx;  /* Context no longer used with new netlink manager */
-
-	/* 
-	 * With the new nlmon_nl_manager, we don't use caches.
-	 * Messages are processed directly via callbacks set up in the manager.
-	 * The old cache-based approach has been replaced with direct message processing.
-	 */
-
+	int netlink, err;
+	
+	g_startup = startup_graph_create();
+	if (!g_startup)
+		return -ENOMEM;
+	
+	netlink = startup_add("netlink", startup_netlink, STARTUP_REQUIRED, -1);
+	if (show_generic_netlink || show_all_protocols)
+		startup_add("multi-protocol", startup_multi_proto, 0, netlink);
+#ifdef ENABLE_QCA
+	if (enable_wmi)
+		startup_add("wmi", startup_wmi, 0, netlink);
+#endif
+	if (monitor_all_netns)
+		startup_add("netns", startup_netns, 0, netlink);
+#ifdef ENABLE_QCA
+	if (enable_qca_control)
+		g_qca_phase = startup_add("qca", startup_qca, STARTUP_LAZY, netlink);
+#endif
+	
+	err = startup_graph_run(g_startup, embedded_mode ? 1 : STARTUP_THREADS);
+	
 	if (verbose_mode) {
-		log_event("Netlink manager initialized successfully");
+		for (int i = 0; i < startup_graph_count(g_startup); i++)
+			if (startup_graph_state(g_startup, i) != STARTUP_PENDING)
+				log_startup_phase(i);
 	}
-
-	return 0;
+	
+	return err;
 }
 
 static int usage(int rc)
 {
-	printf("Usage: nlmon [-h?vciauVD] [-m device] [-p file] [-f type] [-g] [-A] [-w source] [-W expr] [-q iface] [-Q] [-S]\n"
+	printf("Usage: nlmon [-h?vciauVDE] [-C file] [-m device] [-p file] [-b count] [-T cpu] [-U] [-f type|expr] [-g] [-A] [-N] [-w source] [-W expr] [-q iface] [-Q] [-S] [-L secs[,iface...]] [-H socket] [-K socket] [-Z reloads]\n"
 	       "\n"
 	       "Options:\n"
 	       "  -h    This help text\n"
-	       "  -v    Show only events on VETH interfaces\n"
-	       "  -c    Enable CLI mode (interactive ncurses interface)\n"
-	       "  -i    Disable address monitoring\n"
+	       "  -v    Show only events on VETH interfaces\n");
+#ifdef ENABLE_CLI
+	printf("  -c    Enable CLI mode (interactive ncurses interface)\n");
+#endif
+	printf("  -i    Disable address monitoring\n"
 	       "  -a    Disable neighbor/ARP monitoring\n"
 	       "  -u    Disable rules monitoring\n"
+	       "  -C    Load configuration from YAML <file> (see nlmon.yaml.example)\n"
 	       "  -m    Bind to nlmon device (e.g., -m nlmon0) for raw packet capture\n"
 	       "  -p    Write captured netlink packets to PCAP file (requires -m)\n"
+	       "  -b    Receive up to <count> nlmon packets per wakeup with recvmmsg (default 1, max 64)\n"
+	       "  -T    Receive each netlink protocol on its own thread, pinned from <cpu> up (-1 = unpinned)\n"
+	       "  -U    Receive netlink and nlmon sockets through io_uring multishot recv, on one\n"
+	       "        thread with -T (needs Linux 6.0, falls back to recv otherwise)\n"
 	       "  -V    Verbose mode - show detailed netlink message information\n"
 	       "  -D    Debug mode - show raw netlink message details and libnl debugging\n"
-	       "  -f    Filter by netlink message type (e.g., -f 16 for RTM_NEWLINK)\n"
+	       "  -E    Embedded mode - run everything on the main loop, without helper\n"
+	       "        threads or a clock ticker, and report RSS and wakeups (ignores -T)\n"
+	       "  -f    Filter by netlink message type (e.g., -f 16 for RTM_NEWLINK) or by\n"
+	       "        filter expression; header predicates are also applied in the kernel\n"
 	       "  -g    Enable NETLINK_GENERIC protocol monitoring (nl80211, etc.)\n"
 	       "  -A    Monitor all netlink protocols (ROUTE, GENERIC, SOCK_DIAG, NETFILTER)\n"
-	       "  -w    Enable WMI log monitoring from <source> (file path, '-' for stdin, or 'follow:path')\n"
+	       "  -N    Monitor every network namespace, attached and detached as they come\n"
+	       "        and go (needs CAP_SYS_ADMIN)\n");
+#ifdef ENABLE_QCA
+	printf("  -w    Enable WMI log monitoring from <source> (file path, '-' for stdin,\n"
+	       "        'follow:path', or 'replay:path' to replay a whole file on all cores);\n"
+	       "        repeat for several sources, e.g. one per radio, each read on its own thread\n"
 	       "  -W    Filter WMI events with expression (e.g., 'wmi.cmd=REQUEST_STATS')\n"
 	       "  -q    Enable QCA driver control for <iface> (e.g., -q wlan0)\n"
 	       "  -Q    Enable automatic roaming adjustment (requires -q)\n"
 	       "  -S    Collect stats on roam events (requires -q)\n"
+	       "  -L    Poll link stats every <secs>[,iface...] and log changed counters (requires -q)\n");
+#endif
+	printf("  -H    Zero-downtime upgrade through <socket>: take over the sockets and state of\n"
+	       "        the nlmon listening there, if any, then listen for the next one\n"
+	       "  -K    Serve the control protocol on <socket> for nlmon_ctl: stats, named\n"
+	       "        filters, event subscriptions and queries of the recent events\n"
+	       "  -Z    Start up, print how long each phase took, time <reloads> reloads of the\n"
+	       "        -C config and exit instead of monitoring\n"
 	       "\n"
 	       "nlmon Kernel Module Support:\n"
 	       "  The -m option enables binding to a virtual nlmon network device to capture\n"
@@ -1279,18 +3270,24 @@ static int usage(int rc)
 	       "  \n"
 	       "  Example: nlmon -m nlmon0 -p netlink.pcap -V\n"
 	       "  Example: nlmon -m nlmon0 -V -f 16  # Filter only RTM_NEWLINK messages\n"
+	       "  Example: nlmon -m nlmon0 -V -f 'netlink.msg_type IN [16, 17]'\n"
+	       "  Example: nlmon -m nlmon0 -b 32     # Batch up to 32 packets per wakeup\n"
+	       "  Set capture.mmap_ring in the -C config file for zero-copy TPACKET_V3 capture.\n"
 	       "  \n"
 	       "  To manually create an nlmon device:\n"
 	       "    sudo modprobe nlmon\n"
 	       "    sudo ip link add nlmon0 type nlmon\n"
-	       "    sudo ip link set nlmon0 up\n"
-	       "\n"
+	       "    sudo ip link set nlmon0 up\n");
+#ifdef ENABLE_QCA
+	printf("\n"
 	       "WMI Monitoring:\n"
 	       "  The -w option enables monitoring of Qualcomm WMI commands from device logs.\n"
 	       "  \n"
 	       "  Example: nlmon -w /var/log/wlan.log\n"
 	       "  Example: cat device.log | nlmon -w -\n"
 	       "  Example: nlmon -w follow:/var/log/wlan.log  # Follow mode (like tail -f)\n"
+	       "  Example: nlmon -w replay:/tmp/device.log    # Parallel replay in timestamp order\n"
+	       "  Example: nlmon -w follow:/var/log/wlan0.log -w follow:/var/log/wlan1.log\n"
 	       "  Example: nlmon -g -w /var/log/wlan.log      # Combine with netlink monitoring\n"
 	       "  Example: nlmon -w /var/log/wlan.log -W 'wmi.cmd=REQUEST_LINK_STATS'\n"
 	       "\n"
@@ -1309,13 +3306,15 @@ static int usage(int rc)
 	       "    - After roam: Normal roaming (RSSI -70 dBm)\n"
 	       "  \n"
 	       "  Stats collection (-S) automatically collects link layer statistics\n"
-	       "  when roaming events occur.\n"
-	       "\n"
+	       "  when roaming events occur.\n");
+#endif
+	printf("\n"
 	       "Common Message Types:\n"
 	       "  RTM_NEWLINK=16, RTM_DELLINK=17, RTM_NEWADDR=20, RTM_DELADDR=21\n"
 	       "  RTM_NEWROUTE=24, RTM_DELROUTE=25, RTM_NEWNEIGH=28, RTM_DELNEIGH=29\n"
-	       "  RTM_NEWRULE=32, RTM_DELRULE=33\n"
-	       "\n"
+	       "  RTM_NEWRULE=32, RTM_DELRULE=33\n");
+#ifdef ENABLE_CLI
+	printf("\n"
 	       "CLI Mode Keys:\n"
 	       "  q       Quit\n"
 	       "  h       Help\n"
@@ -1323,8 +3322,9 @@ static int usage(int rc)
 	       "  UP/DOWN Scroll through events\n"
 	       "  a       Toggle address monitoring\n"
 	       "  n       Toggle neighbor monitoring\n"
-	       "  r       Toggle rules monitoring\n"
-	       "\n");
+	       "  r       Toggle rules monitoring\n");
+#endif
+	printf("\n");
 
 	return rc;
 }
@@ -1337,11 +3337,22 @@ int main(int argc, char *argv[])
 	ev_signal hupw;
 	ev_io io;
 	ev_io nlmon_io;
+#ifdef ENABLE_CLI
 	ev_timer cli_timer;
+#endif
+	ev_timer stats_timer;
+	ev_timer report_timer;
+#ifdef ENABLE_CONFIG
+	ev_timer watchdog_timer;
+#endif
+	ev_io rx_recv_io;
+	int nl_uring = 0;
 	int err;
 	int fd;
 	int c;
 
+	g_startup_begin_ns = g_startup_last_ns = nlmon_clock_precise_ns();
+	
 	/* Initialize context */
 	memset(&ctx, 0, sizeof(ctx));
 	
@@ -1360,8 +3371,12 @@ int main(int argc, char *argv[])
 	if (!g_signal_handler) {
 		warnx("Failed to initialize signal handler");
 	}
+	
+	/* Coarse time for every subsystem, read without a system call */
+	if (nlmon_clock_start(0) < 0)
+		warnx("Failed to start clock ticker, using the kernel's coarse clocks");
 
-	while ((c = getopt(argc, argv, "h?vciauVDm:p:f:gAw:W:q:QS")) != EOF) {
+	while ((c = getopt(argc, argv, "h?vciauVDEC:m:p:b:T:Uf:gANw:W:q:QSL:H:K:Z:")) != EOF) {
 		switch (c) {
 		case 'h':
 		case '?':
@@ -1371,9 +3386,11 @@ int main(int argc, char *argv[])
 			veth_only = 1;
 			break;
 
+#ifdef ENABLE_CLI
 		case 'c':
 			cli_mode = 1;
 			break;
+#endif
 
 		case 'i':
 			monitor_addr = 0;
@@ -1396,6 +3413,19 @@ int main(int argc, char *argv[])
 			verbose_mode = 1;  /* Debug implies verbose */
 			break;
 			
+		case 'E':
+			embedded_mode = 1;
+			break;
+			
+		case 'C':
+#ifdef ENABLE_CONFIG
+			config_file = optarg;
+#else
+			warnx("Configuration file support (-C) not compiled in");
+			return usage(1);
+#endif
+			break;
+			
 		case 'm':
 			use_nlmon = 1;
 			nlmon_device = optarg;
@@ -1405,15 +3435,52 @@ int main(int argc, char *argv[])
 			pcap_file = optarg;
 			break;
 			
+		case 'b':
+			{
+				char *endptr;
+				long val = strtol(optarg, &endptr, 10);
+				if (*endptr != '\0' || val < 1 || val > NLMON_RX_BATCH_MAX) {
+					warnx("Invalid receive batch size: %s (1-%d)", optarg,
+					      NLMON_RX_BATCH_MAX);
+					return usage(1);
+				}
+				nlmon_rx_batch = (unsigned int)val;
+			}
+			break;
+			
+		case 'T':
+			{
+				char *endptr;
+				long val = strtol(optarg, &endptr, 10);
+				if (*endptr != '\0' || val < -1 || val > 4095) {
+					warnx("Invalid receive thread CPU: %s", optarg);
+					return usage(1);
+				}
+				use_rx_threads = 1;
+				rx_threads_cpu = (int)val;
+			}
+			break;
+			
+		case 'U':
+			use_rx_uring = 1;
+			break;
+			
 		case 'f':
 			{
 				char *endptr;
 				long val = strtol(optarg, &endptr, 10);
-				if (*endptr != '\0' || val < 0 || val > 65535) {
+				if (endptr == optarg || *endptr != '\0') {
+					/* Not a number, a filter expression */
+					filter_expression = optarg;
+					filter_msg_type = -1;
+					break;
+				}
+				if (val < 0 || val > 65535) {
 					warnx("Invalid message type filter: %s", optarg);
 					return usage(1);
 				}
 				filter_msg_type = (int)val;
+				filter_expression = NULL;
 			}
 			break;
 			
@@ -1425,25 +3492,46 @@ int main(int argc, char *argv[])
 			show_all_protocols = 1;
 			break;
 			
-		case 'w':
+		case 'N':
+			monitor_all_netns = 1;
+			break;
+			
+#ifdef ENABLE_QCA
+		case 'w': {
+			struct wmi_source *source;
+			
+			if (wmi_source_count == WMI_MAX_SOURCES) {
+				warnx("At most %d WMI log sources", WMI_MAX_SOURCES);
+				return usage(1);
+			}
+			source = &wmi_sources[wmi_source_count++];
 			enable_wmi = 1;
+			
 			/* Check for "follow:" prefix */
 			if (strncmp(optarg, "follow:", 7) == 0) {
-				wmi_follow_mode = 1;
-				wmi_source = optarg + 7;  /* Skip "follow:" prefix */
+				source->follow_mode = 1;
+				source->path = optarg + 7;  /* Skip "follow:" prefix */
+			} else if (strncmp(optarg, "replay:", 7) == 0) {
+				wmi_replay_mode = 1;
+				source->path = optarg + 7;  /* Skip "replay:" prefix */
 			} else {
-				wmi_source = optarg;
+				source->path = optarg;
 			}
 			
 			/* Validate source */
-			if (strcmp(wmi_source, "-") != 0) {
+			if (wmi_replay_mode && strcmp(source->path, "-") == 0) {
+				warnx("WMI replay needs a file, not stdin");
+				return usage(1);
+			}
+			if (strcmp(source->path, "-") != 0) {
 				/* Check if file exists and is readable */
-				if (access(wmi_source, R_OK) != 0 && !wmi_follow_mode) {
-					warn("Cannot access WMI log source: %s", wmi_source);
+				if (access(source->path, R_OK) != 0 && !source->follow_mode) {
+					warn("Cannot access WMI log source: %s", source->path);
 					return usage(1);
 				}
 			}
 			break;
+		}
 			
 		case 'W':
 			wmi_filter_expr = optarg;
@@ -1460,8 +3548,25 @@ int main(int argc, char *argv[])
 			qca_auto_roaming = 1;
 			break;
 			
-		case 'S':
-			qca_stats_on_roam = 1;
+		case 'S':
+			qca_stats_on_roam = 1;
+			break;
+			
+		case 'L':
+			qca_poll_spec = optarg;
+			break;
+#endif
+			
+		case 'H':
+			upgrade_path = optarg;
+			break;
+			
+		case 'K':
+			control_path = optarg;
+			break;
+			
+		case 'Z':
+			startup_report_reloads = atoi(optarg);
 			break;
 
 		default:
@@ -1470,11 +3575,49 @@ int main(int argc, char *argv[])
 	}
 	
 	/* Validate options */
+#ifdef ENABLE_QCA
+	if (wmi_replay_mode && wmi_source_count > 1) {
+		warnx("WMI replay (-w replay:) takes a single log source");
+		return usage(1);
+	}
+#endif
+	
 	if (pcap_file && !use_nlmon) {
 		warnx("PCAP file output (-p) requires nlmon device (-m)");
 		return usage(1);
 	}
 	
+	/* Readers fall back to the kernel's coarse clocks, which cost no wakeups */
+	if (embedded_mode) {
+		if (use_rx_threads) {
+			warnx("Receive threads (-T) are not used in embedded mode");
+			use_rx_threads = 0;
+		}
+		nlmon_clock_stop();
+	}
+	startup_mark("options");
+
+	/* Take over from the running instance before opening any socket */
+	if (upgrade_path) {
+		err = upgrade_takeover();
+		if (err < 0) {
+			warnx("Failed to take over through %s: %s", upgrade_path, strerror(-err));
+			return 1;
+		}
+		if (err > 0) {
+			upgrade_restore_state();
+			if (verbose_mode)
+				log_event("Taking over from the running nlmon");
+		}
+		startup_mark("takeover");
+	}
+	
+	/* Parse the -f filter before any socket is bound */
+	if (nlmon_filter_init() < 0)
+		return usage(1);
+	startup_mark("filter");
+	
+#ifdef ENABLE_QCA
 	/* Validate WMI options */
 	if (wmi_filter_expr && !enable_wmi) {
 		warnx("WMI filter (-W) requires WMI monitoring (-w)");
@@ -1482,10 +3625,43 @@ int main(int argc, char *argv[])
 	}
 	
 	/* Validate QCA options */
-	if ((qca_auto_roaming || qca_stats_on_roam) && !enable_qca_control) {
-		warnx("QCA options (-Q, -S) require QCA control (-q)");
+	if ((qca_auto_roaming || qca_stats_on_roam || qca_poll_spec) && !enable_qca_control) {
+		warnx("QCA options (-Q, -S, -L) require QCA control (-q)");
 		return usage(1);
 	}
+#endif
+	
+#ifdef ENABLE_CONFIG
+	/* Load configuration file if requested */
+	if (config_file) {
+		err = nlmon_config_ctx_init(&g_config_ctx, config_file);
+		if (err != NLMON_CONFIG_OK) {
+			warnx("Failed to load configuration %s: %s", config_file,
+			      nlmon_config_error_string(err));
+			return 1;
+		}
+		if (nlmon_config_ctx_set_prepare(&g_config_ctx, config_prepare, NULL) != NLMON_CONFIG_OK) {
+			nlmon_config_ctx_free(&g_config_ctx);
+			return 1;
+		}
+		g_config_loaded = 1;
+		nlmon_config_get_capture(&g_config_ctx, &capture_cfg);
+		nlmon_config_get_threads(&g_config_ctx, &threads_cfg);
+		
+		/* Before any ring or pool is allocated */
+		{
+			struct nlmon_core_config core_cfg;
+			struct huge_alloc_config huge_cfg;
+			
+			nlmon_config_get_core(&g_config_ctx, &core_cfg);
+			huge_cfg.mode = (enum huge_alloc_mode)core_cfg.hugepages;
+			huge_cfg.min_size = core_cfg.hugepage_min_size;
+			huge_cfg.prefault = core_cfg.hugepage_prefault;
+			huge_alloc_configure(&huge_cfg);
+		}
+	}
+#endif
+	startup_mark("config");
 	
 	/* Setup nlmon if requested */
 	if (use_nlmon) {
@@ -1494,8 +3670,18 @@ int main(int argc, char *argv[])
 		if (!nlmon_device)
 			nlmon_device = "nlmon0";
 		
+		/* The predecessor's socket is bound to the device already */
+		if (g_upgrade)
+			nlmon_sock = nlmon_upgrade_take_fd(g_upgrade, NLMON_UPGRADE_FD_CAPTURE);
+		
 		/* Check if the specified interface exists and is an nlmon device */
-		if (check_interface_type(nlmon_device, &is_nlmon) == 0 && is_nlmon) {
+		if (nlmon_sock >= 0) {
+			if (verbose_mode) {
+				char msg[256];
+				snprintf(msg, sizeof(msg), "Took over nlmon device capture: %s", nlmon_device);
+				log_event(msg);
+			}
+		} else if (check_interface_type(nlmon_device, &is_nlmon) == 0 && is_nlmon) {
 			/* It's an nlmon device, bind to it */
 			nlmon_sock = bind_nlmon_socket(nlmon_device);
 			if (nlmon_sock < 0) {
@@ -1525,6 +3711,34 @@ int main(int argc, char *argv[])
 			}
 		}
 		
+		/* Map the zero-copy receive ring, falling back to recvmmsg */
+		if (use_nlmon && capture_cfg.mmap_ring) {
+			if (nlmon_rx_ring_init(nlmon_sock, &capture_cfg) < 0) {
+				warnx("mmap capture ring unavailable, falling back to recvmmsg");
+				nlmon_rx_ring_cleanup();
+				/* PACKET_VERSION cannot be reset once set, start over */
+				close(nlmon_sock);
+				nlmon_sock = bind_nlmon_socket(nlmon_device);
+				if (nlmon_sock < 0)
+					use_nlmon = 0;
+			} else if (verbose_mode) {
+				char msg[256];
+				snprintf(msg, sizeof(msg),
+				         "nlmon capture ring: %d blocks of %zu bytes, %d ms timeout",
+				         capture_cfg.ring_block_count, capture_cfg.ring_block_size,
+				         capture_cfg.ring_block_timeout_ms);
+				log_event(msg);
+			}
+		}
+		
+		/* Preallocate the receive batch */
+		if (use_nlmon && !rx_ring.map && nlmon_rx_batch_init(nlmon_rx_batch) < 0) {
+			warnx("Failed to allocate nlmon receive buffers");
+			close(nlmon_sock);
+			nlmon_sock = -1;
+			use_nlmon = 0;
+		}
+		
 		/* Setup PCAP file if requested */
 		if (use_nlmon && pcap_file) {
 			if (init_pcap_file(pcap_file) < 0) {
@@ -1533,140 +3747,39 @@ int main(int argc, char *argv[])
 			}
 		}
 	}
+	startup_mark("capture");
+
+	/* Verbose and debug lines are formatted by a writer thread, or as
+	 * they are logged in embedded mode */
+	nlmon_log_set_sink(nlmon_log_sink, NULL);
+	if (verbose_mode && !embedded_mode && nlmon_log_start(0) < 0)
+		warnx("Failed to start log writer, logging synchronously");
 
+#ifdef ENABLE_CLI
 	/* Initialize CLI mode if requested */
 	if (cli_mode)
 		init_cli();
+#endif
+	startup_mark("log");
 
-	/* Initialize multi-protocol support if requested */
-	if (show_generic_netlink || show_all_protocols) {
-		g_multi_proto_ctx = nlmon_multi_protocol_init();
-		if (!g_multi_proto_ctx) {
-			warnx("Failed to initialize multi-protocol support");
-		} else {
-			nlmon_multi_protocol_set_callback(g_multi_proto_ctx, genetlink_event_cb, NULL);
-			
-			if (show_generic_netlink || show_all_protocols) {
-				if (nlmon_multi_protocol_enable(g_multi_proto_ctx, NLMON_PROTO_GENERIC) == 0) {
-					if (verbose_mode)
-						log_event("NETLINK_GENERIC monitoring enabled");
-				} else {
-					warnx("Failed to enable NETLINK_GENERIC monitoring");
-				}
-			}
-			
-			if (show_all_protocols) {
-				if (nlmon_multi_protocol_enable(g_multi_proto_ctx, NLMON_PROTO_SOCK_DIAG) == 0) {
-					if (verbose_mode)
-						log_event("NETLINK_SOCK_DIAG monitoring enabled");
-				} else {
-					warnx("Failed to enable NETLINK_SOCK_DIAG monitoring");
-				}
-			}
-		}
-	}
-	
-	/* Initialize WMI monitoring if requested */
-	if (enable_wmi) {
-		struct wmi_log_config wmi_config;
-		struct wmi_bridge_config bridge_config;
-		
-		/* Initialize WMI event bridge first */
-		memset(&bridge_config, 0, sizeof(bridge_config));
-		bridge_config.event_processor = NULL;  /* Not using event processor for now */
-		bridge_config.verbose = verbose_mode;
-		bridge_config.user_data = NULL;
-		
-		if (wmi_bridge_init(&bridge_config) < 0) {
-			warnx("Failed to initialize WMI event bridge");
-			enable_wmi = 0;
-		} else {
-			/* Configure WMI log reader */
-			memset(&wmi_config, 0, sizeof(wmi_config));
-			wmi_config.log_source = wmi_source;
-			wmi_config.follow_mode = wmi_follow_mode;
-			wmi_config.buffer_size = 4096;
-			wmi_config.callback = wmi_log_line_cb;
-			wmi_config.user_data = NULL;
-			
-			if (wmi_log_reader_init(&wmi_config) < 0) {
-				warnx("Failed to initialize WMI log reader");
-				wmi_bridge_cleanup();
-				enable_wmi = 0;
-			} else {
-				if (verbose_mode) {
-					char msg[256];
-					snprintf(msg, sizeof(msg), "WMI monitoring enabled: source=%s%s",
-					         wmi_follow_mode ? "follow:" : "", wmi_source);
-					log_event(msg);
-				}
-				
-				/* Start WMI reader thread */
-				if (pthread_create(&wmi_thread, NULL, wmi_reader_thread, NULL) != 0) {
-					warn("Failed to create WMI reader thread");
-					wmi_log_reader_cleanup();
-					wmi_bridge_cleanup();
-					enable_wmi = 0;
-				} else {
-					wmi_thread_started = 1;
-				}
-			}
-		}
-	}
-
-	/* Initialize QCA driver control if requested */
-	if (enable_qca_control) {
-		if (qca_nlmon_init(qca_interface, verbose_mode) < 0) {
-			warnx("Failed to initialize QCA driver control");
-			enable_qca_control = 0;
-		} else {
-			if (verbose_mode) {
-				char msg[256];
-				snprintf(msg, sizeof(msg), "QCA driver control enabled for %s", qca_interface);
-				log_event(msg);
-			}
-			
-			/* Configure auto roaming if enabled */
-			if (qca_auto_roaming) {
-				qca_nlmon_enable_auto_roaming(1);
-				qca_nlmon_set_roaming_thresholds(75, 70, 65);
-				if (verbose_mode) {
-					log_event("Auto roaming adjustment enabled");
-				}
-			}
-			
-			/* Configure stats collection if enabled */
-			if (qca_stats_on_roam) {
-				qca_nlmon_enable_stats_on_roam(1);
-				if (verbose_mode) {
-					log_event("Stats collection on roam enabled");
-				}
-			}
-		}
-	}
-
-	/* Initialize new netlink manager */
-	g_nl_manager = nlmon_nl_manager_init();
-	if (!g_nl_manager) {
-		warnx("Failed to initialize netlink manager");
-		return 1;
-	}
-
-	/* Set event callback for netlink manager */
-	nlmon_nl_set_callback(g_nl_manager, netlink_manager_event_cb, NULL);
-
-	/* Enable NETLINK_ROUTE protocol (always enabled) */
-	err = nlmon_nl_enable_route(g_nl_manager);
-	if (err < 0) {
-		warnx("Failed to enable NETLINK_ROUTE: %d", err);
+	/* Netlink monitoring first, then everything else in parallel */
+	if (nlmon_startup() < 0) {
 	fail:
+		/* The predecessor resumes */
+		upgrade_complete(-ECANCELED);
+#ifdef ENABLE_CLI
 		if (cli_mode)
 			cleanup_cli();
+#endif
 		if (g_nl_manager)
 			nlmon_nl_manager_destroy(g_nl_manager);
 		cleanup_memory_management();
+		nlmon_log_stop();
+		nlmon_clock_stop();
 		return 1;
 	}
+	g_subsystems_mark = g_startup_mark_count;
+	startup_mark("subsystems");
 
 	fd = nlmon_nl_get_route_fd(g_nl_manager);
 	if (fd == -1) {
@@ -1674,48 +3787,155 @@ int main(int argc, char *argv[])
 		goto fail;
 	}
 
-	/* Enable NETLINK_GENERIC if requested */
-	if (show_generic_netlink || show_all_protocols) {
-		err = nlmon_nl_enable_generic(g_nl_manager);
-		if (err < 0) {
-			warnx("Failed to enable NETLINK_GENERIC: %d", err);
-			/* Non-fatal - continue without generic netlink */
-		} else if (verbose_mode) {
-			log_event("NETLINK_GENERIC enabled via netlink manager");
-		}
-	}
-
-	/* Enable NETLINK_SOCK_DIAG if requested */
-	if (show_all_protocols) {
-		err = nlmon_nl_enable_diag(g_nl_manager);
-		if (err < 0) {
-			warnx("Failed to enable NETLINK_SOCK_DIAG: %d", err);
-			/* Non-fatal - continue without socket diagnostics */
-		} else if (verbose_mode) {
-			log_event("NETLINK_SOCK_DIAG enabled via netlink manager");
-		}
-	}
-
-	/* Enable NETLINK_NETFILTER if requested */
-	if (show_all_protocols) {
-		err = nlmon_nl_enable_netfilter(g_nl_manager);
-		if (err < 0) {
-			warnx("Failed to enable NETLINK_NETFILTER: %d", err);
-			/* Non-fatal - continue without netfilter */
-		} else if (verbose_mode) {
-			log_event("NETLINK_NETFILTER enabled via netlink manager");
-		}
-	}
-
 	/* Legacy init function - may need updating */
 	if (init(&ctx))
 		goto fail;
+	startup_mark("init");
 
 	loop = ev_default_loop(EVFLAG_NOENV);
 	ev_set_userdata(loop, &ctx);
 
-	ev_io_init(&io, nlroute_cb, fd, EV_READ);
-	ev_io_start(loop, &io);
+	/* Hand the netlink manager sockets to per-protocol receive threads */
+	if (use_rx_threads) {
+		struct event_processor_config ep_config = {
+			.ring_buffer_size = 4096,
+			.thread_pool_size = 1,     /* Event callback and stats are not thread-safe */
+			.work_queue_size = 4096,
+			.enable_object_pool = true,
+			.object_pool_size = 4096,
+			/* Bulk conntrack and scan results must not delay link and route changes */
+			.priority_classes = 3,
+			.priority = { { 1024, 16 }, { 4096, 4 }, { 4096, 1 } },
+			.priority_policy = EVENT_PRIORITY_WEIGHTED,
+			.default_priority = 1,
+			.overload_policy = EVENT_OVERLOAD_DROP_PRIORITY,
+			.dispatcher_cpus = threads_cfg.dispatcher_cpus,
+			.worker_cpus = threads_cfg.worker_cpus,
+			.thread_name = "rx",
+		};
+		
+		g_rx_processor = event_processor_create(&ep_config);
+		if (!g_rx_processor) {
+			warnx("Failed to create event processor for receive threads");
+			goto fail;
+		}
+		event_processor_set_classifier(g_rx_processor, rx_event_priority, NULL);
+		
+		err = -EOPNOTSUPP;
+		if (use_rx_uring) {
+			err = nlmon_nl_start_rx_uring(g_nl_manager, g_rx_processor, rx_threads_cpu);
+			if (err < 0)
+				warnx("io_uring receive unavailable (%d), using receive threads", err);
+		}
+		if (err < 0)
+			err = nlmon_nl_start_rx_threads(g_nl_manager, g_rx_processor, rx_threads_cpu);
+		if (err < 0) {
+			warnx("Failed to start netlink receive threads: %d", err);
+			event_processor_destroy(g_rx_processor, false);
+			g_rx_processor = NULL;
+			goto fail;
+		}
+		
+		if (verbose_mode) {
+			char msg[128];
+			snprintf(msg, sizeof(msg), "Started %d netlink receive threads", err);
+			log_event(msg);
+		}
+	} else {
+		/* One ring for every socket the main loop receives from */
+		if (use_rx_uring) {
+			g_rx_recv = io_recv_create(NULL);
+			if (!g_rx_recv)
+				warn("io_uring receive unavailable, using recv");
+		}
+		if (g_rx_recv) {
+			err = nlmon_nl_attach_io_recv(g_nl_manager, g_rx_recv);
+			if (err < 0)
+				warnx("Failed to receive netlink sockets through io_uring: %d", err);
+			nl_uring = err > 0;
+		}
+		if (!nl_uring) {
+			ev_io_init(&io, nlroute_cb, fd, EV_READ);
+			ev_io_start(loop, &io);
+		}
+	}
+	startup_mark("receive");
+	
+#ifdef ENABLE_CONFIG
+	if (g_config_loaded) {
+		struct nlmon_core_config core_cfg;
+		
+		nlmon_config_get_core(&g_config_ctx, &core_cfg);
+		if (core_cfg.memory_budget) {
+			struct memory_governor_config gov_cfg = {
+				.budget = core_cfg.memory_budget,
+				.count_rss = true,
+			};
+			
+			g_memory_governor = memory_governor_create(&gov_cfg);
+			if (!g_memory_governor)
+				warnx("Failed to create memory governor");
+		}
+		if (core_cfg.stall_ms) {
+			g_watchdog_config = (struct nlmon_watchdog_config) {
+				.stall_ms = core_cfg.stall_ms,
+				.restart = core_cfg.stall_restart,
+				.on_stall = pipeline_stall_cb,
+			};
+			
+			/* Embedded mode scans from a timer, like the stats bus */
+			if (embedded_mode) {
+				ev_timer_init(&watchdog_timer, watchdog_timer_cb,
+				              core_cfg.stall_ms / 4000.0, core_cfg.stall_ms / 4000.0);
+				ev_timer_start(loop, &watchdog_timer);
+			} else if (nlmon_watchdog_start(&g_watchdog_config) < 0) {
+				warnx("Failed to start the pipeline watchdog");
+			}
+		}
+	}
+#endif
+	/* The receive buffers are ours to shrink, the rest counts by RSS */
+	if (g_memory_governor && g_nl_limits)
+		memory_governor_add(g_memory_governor, "netlink", 25, nlmon_nl_limits_memory_usage,
+		                    nlmon_nl_limits_memory_respond, g_nl_limits);
+	
+	if (g_rx_processor || g_nl_limits || g_memory_governor) {
+		g_stats_bus = stats_bus_create(STATS_BUS_DEFAULT_INTERVAL_MS);
+		if (g_stats_bus) {
+			if (g_rx_processor)
+				stats_bus_add_source(g_stats_bus, event_processor_collect_stats, g_rx_processor);
+			if (g_nl_limits)
+				stats_bus_add_source(g_stats_bus, nlmon_nl_limits_collect_stats, g_nl_limits);
+			stats_bus_add_source(g_stats_bus, adaptive_batch_collect_stats, NULL);
+			stats_bus_add_source(g_stats_bus, huge_alloc_collect_stats, NULL);
+			if (g_memory_governor)
+				stats_bus_subscribe(g_stats_bus, memory_governor_notify, g_memory_governor);
+			if (embedded_mode) {
+				stats_bus_publish(g_stats_bus);
+				ev_timer_init(&stats_timer, stats_bus_timer_cb,
+				              STATS_BUS_DEFAULT_INTERVAL_MS / 1000.0,
+				              STATS_BUS_DEFAULT_INTERVAL_MS / 1000.0);
+				ev_timer_start(loop, &stats_timer);
+			} else if (stats_bus_start(g_stats_bus) < 0) {
+				warnx("Failed to start the stats bus");
+				stats_bus_destroy(g_stats_bus);
+				g_stats_bus = NULL;
+			}
+		}
+	}
+	startup_mark("stats");
+	
+	if (control_path) {
+		struct cli_control_context control_ctx = { .stats_bus = g_stats_bus };
+		
+		/* Named filters live as long as the daemon, nothing persists them */
+		g_control_filters = filter_manager_create(NULL);
+		control_ctx.filter_mgr = g_control_filters;
+		g_control = cli_control_server_create(control_path, &control_ctx);
+		if (!g_control)
+			warnx("Failed to serve control clients on %s: %s", control_path, strerror(errno));
+		startup_mark("control");
+	}
 
 	ev_signal_init (&intw, sigint_cb, SIGINT);
 	ev_signal_start (loop, &intw);
@@ -1723,39 +3943,50 @@ int main(int argc, char *argv[])
 	ev_signal_init (&hupw, sighub_cb, SIGHUP);
 	ev_signal_start (loop, &hupw);
 
+#ifdef ENABLE_CLI
 	/* Initialize CLI update timer if in CLI mode */
 	if (cli_mode) {
 		ev_timer_init(&cli_timer, cli_update_cb, 0.0, 0.1);
 		ev_timer_start(loop, &cli_timer);
 	}
+#endif
 	
 	/* Initialize nlmon watcher if enabled */
 	if (use_nlmon && nlmon_sock >= 0) {
-		ev_io_init(&nlmon_io, nlmon_packet_cb, nlmon_sock, EV_READ);
-		ev_io_start(loop, &nlmon_io);
+		/* The mmap ring is zero-copy already, io_uring only replaces recvmmsg */
+		if (rx_ring.map) {
+			ev_io_init(&nlmon_io, nlmon_ring_cb, nlmon_sock, EV_READ);
+			ev_io_start(loop, &nlmon_io);
+		} else {
+			if (g_rx_recv)
+				rx_recv_nlmon_source = io_recv_add(g_rx_recv, nlmon_sock,
+				                                   sizeof(struct sockaddr_ll),
+				                                   nlmon_recv_cb, NULL);
+			if (rx_recv_nlmon_source < 0) {
+				ev_io_init(&nlmon_io, nlmon_packet_cb, nlmon_sock, EV_READ);
+				ev_io_start(loop, &nlmon_io);
+			}
+		}
+	}
+	
+	/* Submit the receives, then wake up for their completions */
+	if (g_rx_recv) {
+		io_recv_run(g_rx_recv, false);
+		ev_io_init(&rx_recv_io, rx_recv_cb, io_recv_get_fd(g_rx_recv), EV_READ);
+		ev_io_start(loop, &rx_recv_io);
 	}
 	
-	/* Initialize genetlink watchers if enabled (legacy multi-protocol support) */
-	ev_io genetlink_io, sock_diag_io;
+	/* Initialize the genetlink/sock_diag watcher if enabled (legacy multi-protocol support) */
+	ev_io genetlink_io;
 	if (g_multi_proto_ctx) {
-		int genl_fd = nlmon_multi_protocol_get_fd(g_multi_proto_ctx, NLMON_PROTO_GENERIC);
-		if (genl_fd >= 0) {
-			ev_io_init(&genetlink_io, genetlink_io_cb, genl_fd, EV_READ);
-			genetlink_io.data = (void *)(intptr_t)NLMON_PROTO_GENERIC;
-			ev_io_start(loop, &genetlink_io);
-		}
-		
-		int diag_fd = nlmon_multi_protocol_get_fd(g_multi_proto_ctx, NLMON_PROTO_SOCK_DIAG);
-		if (diag_fd >= 0) {
-			ev_io_init(&sock_diag_io, genetlink_io_cb, diag_fd, EV_READ);
-			sock_diag_io.data = (void *)(intptr_t)NLMON_PROTO_SOCK_DIAG;
-			ev_io_start(loop, &sock_diag_io);
-		}
+		ev_io_init(&genetlink_io, genetlink_io_cb,
+		           nlmon_multi_protocol_get_epoll_fd(g_multi_proto_ctx), EV_READ);
+		ev_io_start(loop, &genetlink_io);
 	}
 
 	/* Initialize netlink manager watchers for additional protocols */
 	ev_io nl_route_io, nl_genl_io, nl_diag_io, nl_nf_io;
-	if (g_nl_manager) {
+	if (g_nl_manager && !g_rx_processor && !nl_uring) {
 		/* Add NETLINK_ROUTE watcher (always enabled) */
 		int route_fd = nlmon_nl_get_route_fd(g_nl_manager);
 		if (route_fd >= 0) {
@@ -1793,23 +4024,201 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/* Other namespaces share one epoll fd, however many there are */
+	ev_io netns_io, netns_watch_io;
+	ev_timer netns_timer;
+	if (g_netns_set) {
+		ev_io_init(&netns_io, netns_io_cb, nlmon_nl_netns_get_fd(g_netns_set), EV_READ);
+		ev_io_start(loop, &netns_io);
+		if (namespace_tracker_get_fd(g_ns_tracker) >= 0) {
+			ev_io_init(&netns_watch_io, netns_watch_cb,
+			           namespace_tracker_get_fd(g_ns_tracker), EV_READ);
+			ev_io_start(loop, &netns_watch_io);
+		}
+		ev_timer_init(&netns_timer, netns_timer_cb, NETNS_SYNC_INTERVAL,
+		              NETNS_SYNC_INTERVAL);
+		ev_timer_start(loop, &netns_timer);
+		
+		if (verbose_mode) {
+			struct nlmon_nl_netns_stats ns_stats;
+			char msg[128];
+			
+			nlmon_nl_netns_get_stats(g_netns_set, &ns_stats);
+			snprintf(msg, sizeof(msg), "Monitoring %zu other network namespaces",
+			         ns_stats.namespaces);
+			log_event(msg);
+		}
+	}
+
+#ifdef ENABLE_QCA
+	if (qca_poll_spec && qca_poll_start(loop) < 0)
+		goto fail;
+	if (enable_wmi && embedded_mode)
+		wmi_sources_watch(loop);
+#endif
+
+	/* Everything is open, the predecessor can go */
+	if (upgrade_complete(0) < 0) {
+		warnx("The previous nlmon stopped waiting and resumed, exiting");
+		goto fail;
+	}
+	
+	/* Then wait for a successor in turn */
+	ev_io upgrade_io;
+	if (upgrade_path) {
+		upgrade_listen_fd = nlmon_upgrade_listen(upgrade_path);
+		if (upgrade_listen_fd < 0) {
+			warnx("Failed to listen for upgrades on %s: %s", upgrade_path,
+			      strerror(-upgrade_listen_fd));
+		} else {
+			ev_io_init(&upgrade_io, upgrade_cb, upgrade_listen_fd, EV_READ);
+			ev_io_start(loop, &upgrade_io);
+		}
+	}
+
+	/* Report what embedded mode costs while it runs, and at exit */
+	g_report_time = ev_now(loop);
+	if (embedded_mode && verbose_mode) {
+		ev_timer_init(&report_timer, embedded_report_cb, EMBEDDED_REPORT_INTERVAL,
+		              EMBEDDED_REPORT_INTERVAL);
+		ev_timer_start(loop, &report_timer);
+	}
+
+	startup_mark("watchers");
+
 	/* Start event loop, remain there until ev_unloop() is called. */
-	ev_run(loop, 0);
+	if (startup_report_reloads >= 0)
+		startup_report();
+	else
+		ev_run(loop, 0);
+
+	if (embedded_mode && verbose_mode)
+		embedded_report(loop);
+	
+	/* A successor has replaced the socket, otherwise the next start is fresh */
+	if (upgrade_listen_fd >= 0) {
+		close(upgrade_listen_fd);
+		if (!upgrade_handed_over)
+			unlink(upgrade_path);
+	}
 
+	/* Cleanup other namespaces, closing their sockets */
+	nlmon_nl_netns_destroy(g_netns_set);
+	g_netns_set = NULL;
+	namespace_tracker_destroy(g_ns_tracker);
+	g_ns_tracker = NULL;
+
+	/* Control clients read the bus and the filters */
+	cli_control_server_destroy(g_control);
+	g_control = NULL;
+	filter_manager_destroy(g_control_filters);
+	g_control_filters = NULL;
+	
+	/* The bus reads the modules below, stop it first */
+	stats_bus_destroy(g_stats_bus);
+	g_stats_bus = NULL;
+	nlmon_watchdog_stop();
+	
+	if (g_memory_governor) {
+		if (verbose_mode) {
+			struct memory_governor_stats ms;
+			char msg[160];
+			
+			memory_governor_get_stats(g_memory_governor, &ms);
+			snprintf(msg, sizeof(msg),
+			         "memory: %zu of %zu bytes, peak pressure %s, %lu escalations",
+			         ms.rss > ms.usage ? ms.rss : ms.usage, ms.budget,
+			         memory_pressure_name(ms.peak_level), (unsigned long)ms.escalations);
+			log_event(msg);
+		}
+		memory_governor_destroy(g_memory_governor);
+		g_memory_governor = NULL;
+	}
+	
+	/* The ring receives from manager sockets, destroy it first */
+	if (g_rx_recv) {
+		if (verbose_mode) {
+			struct io_recv_stats rs;
+			char msg[256];
+			
+			io_recv_get_stats(g_rx_recv, &rs);
+			snprintf(msg, sizeof(msg),
+			         "io_uring receive: %lu datagrams in %lu batches, %lu re-arms, %lu dry rings",
+			         (unsigned long)rs.datagrams, (unsigned long)rs.batches,
+			         (unsigned long)rs.rearms, (unsigned long)rs.exhausted);
+			log_event(msg);
+		}
+		nlmon_nl_detach_io_recv(g_nl_manager);
+		io_recv_destroy(g_rx_recv);
+		g_rx_recv = NULL;
+	}
+	
 	/* Cleanup new netlink manager */
 	if (g_nl_manager) {
+		nlmon_nl_stop_rx_threads(g_nl_manager);
+		if (verbose_mode) {
+			struct nlmon_nl_resync_stats rs;
+			char msg[256];
+			
+			nlmon_nl_get_resync_stats(g_nl_manager, &rs);
+			snprintf(msg, sizeof(msg),
+			         "netlink overruns: %lu (route %lu), %lu resyncs (%lu failed), %lu delta events",
+			         (unsigned long)rs.overruns, (unsigned long)rs.route_overruns,
+			         (unsigned long)rs.resyncs, (unsigned long)rs.resync_failures,
+			         (unsigned long)rs.delta_events);
+			log_event(msg);
+		}
 		nlmon_nl_manager_destroy(g_nl_manager);
 		g_nl_manager = NULL;
 	}
+	if (g_rx_processor) {
+		event_processor_destroy(g_rx_processor, true);
+		g_rx_processor = NULL;
+	}
+	nlmon_nl_limits_destroy(g_nl_limits);
+	g_nl_limits = NULL;
 	
 	/* Cleanup nlmon resources */
+	if (use_nlmon && verbose_mode) {
+		char msg[256];
+		nlmon_rx_ring_update_stats();
+		snprintf(msg, sizeof(msg),
+		         "nlmon ingest: %lu pkts, %lu msgs, %lu wakeups, %lu batches (%lu full, max %u), %lu truncated, %lu ring drops",
+		         rx_stats.packets, rx_stats.messages, rx_stats.wakeups,
+		         rx_stats.batches, rx_stats.full_batches, rx_stats.max_batch,
+		         rx_stats.truncated, rx_stats.ring_drops);
+		log_event(msg);
+	}
+	nlmon_rx_ring_cleanup();
 	if (nlmon_sock >= 0)
 		close(nlmon_sock);
+	nlmon_rx_batch_cleanup();
 	if (pcap_fp)
 		fclose(pcap_fp);
+	nlmon_filter_cleanup();
 	
 	/* Cleanup memory management and resource tracking */
 	cleanup_memory_management();
+	
+#ifdef ENABLE_CONFIG
+	if (g_reload_started)
+		pthread_join(g_reload_thread, NULL);
+	if (g_config_loaded)
+		nlmon_config_ctx_free(&g_config_ctx);
+#endif
+	if (verbose_mode) {
+		struct nlmon_log_stats ls;
+		char msg[128];
+
+		nlmon_log_get_stats(&ls);
+		if (ls.dropped) {
+			snprintf(msg, sizeof(msg), "log ring: %llu records, %llu dropped",
+			         (unsigned long long)ls.logged, (unsigned long long)ls.dropped);
+			log_event(msg);
+		}
+	}
+	nlmon_log_stop();
+	nlmon_clock_stop();
 
 	return 0;
 }
@@ -0,0 +1,88 @@
+/*
+ * nlmon_bindump - Print events of an nlmon binary export file
+ *
+ * Usage:
+ *   nlmon_bindump [-c] [-x] <file>
+ *
+ *   -c  Only count events
+ *   -x  Hex dump raw netlink messages
+ */
+
+#include "binary_export.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+static void hex_dump(const unsigned char *data, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		printf("%s%02x%s", i % 16 ? "" : "    ", data[i],
+		       i % 16 == 15 || i + 1 == len ? "\n" : " ");
+}
+
+int main(int argc, char **argv)
+{
+	struct binary_reader_event ev;
+	struct binary_reader *reader;
+	bool count_only = false, hex = false;
+	uint64_t count = 0;
+	int opt;
+	
+	while ((opt = getopt(argc, argv, "cx")) != -1) {
+		switch (opt) {
+		case 'c':
+			count_only = true;
+			break;
+		case 'x':
+			hex = true;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-c] [-x] <file>\n", argv[0]);
+			return 2;
+		}
+	}
+	
+	if (optind != argc - 1) {
+		fprintf(stderr, "Usage: %s [-c] [-x] <file>\n", argv[0]);
+		return 2;
+	}
+	
+	reader = binary_reader_open(argv[optind]);
+	if (!reader) {
+		fprintf(stderr, "%s: %s\n", argv[optind],
+		        errno == EPROTO ? "not a binary export of this version" : strerror(errno));
+		return 1;
+	}
+	
+	while (binary_reader_next(reader, &ev)) {
+		count++;
+		if (count_only)
+			continue;
+		
+		printf("%" PRIu64 " seq=%" PRIu64 " type=%u msg_type=%u interface=%s"
+		       " protocol=%d nlmsg_type=%u flags=0x%x nlmsg_seq=%u pid=%u",
+		       ev.event->timestamp, ev.event->sequence, ev.event->event_type,
+		       ev.event->message_type, ev.interface[0] ? ev.interface : "-",
+		       ev.event->nl_protocol, ev.event->nl_msg_type, ev.event->nl_msg_flags,
+		       ev.event->nl_seq, ev.event->nl_pid);
+		if (ev.genl_family[0] || ev.event->genl_family_id)
+			printf(" genl=%s/%u cmd=%u version=%u",
+			       ev.genl_family[0] ? ev.genl_family : "-", ev.event->genl_family_id,
+			       ev.event->genl_cmd, ev.event->genl_version);
+		if (ev.event->sample_weight > 1)
+			printf(" weight=%u", ev.event->sample_weight);
+		printf(" raw=%zu\n", ev.raw_len);
+		
+		if (hex && ev.raw)
+			hex_dump(ev.raw, ev.raw_len);
+	}
+	
+	if (count_only)
+		printf("%" PRIu64 "\n", count);
+	
+	binary_reader_close(reader);
+	return 0;
+}
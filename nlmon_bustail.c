@@ -0,0 +1,80 @@
+/*
+ * nlmon_bustail - Follow the events of an nlmon shared memory event bus
+ *
+ * Usage:
+ *   nlmon_bustail [-o] [name]
+ *
+ *   -o  Start with the oldest event the bus still holds
+ *   name defaults to EVENT_BUS_DEFAULT_NAME
+ *
+ * Built against libnlmon-bus.a only, as an example of a local consumer.
+ */
+
+#include "event_bus.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+int main(int argc, char **argv)
+{
+	const struct event_bus_record *rec;
+	struct event_bus_reader *reader;
+	const char *name = EVENT_BUS_DEFAULT_NAME;
+	unsigned int flags = 0;
+	uint64_t lost = 0;
+	int opt, ret;
+	
+	while ((opt = getopt(argc, argv, "o")) != -1) {
+		switch (opt) {
+		case 'o':
+			flags |= EVENT_BUS_FROM_OLDEST;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-o] [name]\n", argv[0]);
+			return 2;
+		}
+	}
+	
+	if (optind < argc)
+		name = argv[optind];
+	
+	reader = event_bus_reader_open(name, flags);
+	if (!reader) {
+		fprintf(stderr, "%s: %s\n", name,
+		        errno == EPROTO ? "not an event bus of this version" : strerror(errno));
+		return 1;
+	}
+	
+	for (;;) {
+		ret = event_bus_reader_peek(reader, &rec);
+		if (ret == -EAGAIN) {
+			ret = event_bus_reader_wait(reader, -1);
+			if (ret == 0 || ret == -EINTR)
+				continue;
+		}
+		if (ret < 0)
+			break;
+	
+		/* Print in place, then drop the line if the record changed under it */
+		printf("%" PRIu64 " seq=%" PRIu64 " type=%u msg_type=%u interface=%s"
+		       " protocol=%d nlmsg_type=%u nlmsg_seq=%u pid=%u raw=%u\n",
+		       rec->event.timestamp, rec->event.sequence, rec->event.event_type,
+		       rec->event.message_type, rec->interface[0] ? rec->interface : "-",
+		       rec->event.nl_protocol, rec->event.nl_msg_type, rec->event.nl_seq,
+		       rec->event.nl_pid, rec->event.raw_len);
+		if (!event_bus_reader_release(reader))
+			printf("(overwritten while printed)\n");
+	
+		if (event_bus_reader_lost(reader) != lost) {
+			fprintf(stderr, "lost %" PRIu64 " events\n", event_bus_reader_lost(reader) - lost);
+			lost = event_bus_reader_lost(reader);
+		}
+		fflush(stdout);
+	}
+	
+	event_bus_reader_close(reader);
+	return ret == -EPIPE ? 0 : 1;
+}
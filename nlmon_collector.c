@@ -0,0 +1,102 @@
+/*
+ * nlmon_collector - Receive the event streams of nlmon exporters
+ *
+ * Usage:
+ *   nlmon_collector [-b address] [-p port] [-w workers] [-c count]
+ *
+ *   -b  Address to listen on, any by default
+ *   -p  Port, EVENT_STREAM_PORT by default
+ *   -w  Threads serving connections, 1 by default
+ *   -c  Exit after count events
+ *
+ * Prints one line per event, prefixed by the node that sent it.
+ */
+
+#include "event_stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+static atomic_bool stop;
+static uint64_t limit;
+static pthread_mutex_t print_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	atomic_store(&stop, true);
+}
+
+static void on_event(const char *node, const struct event_bus_record *rec, void *ctx)
+{
+	uint64_t *count = ctx;
+	
+	/* Workers call in concurrently */
+	pthread_mutex_lock(&print_lock);
+	printf("%s %" PRIu64 " seq=%" PRIu64 " type=%u msg_type=%u interface=%s"
+	       " protocol=%d nlmsg_type=%u nlmsg_seq=%u pid=%u raw=%u\n",
+	       node, rec->event.timestamp, rec->event.sequence, rec->event.event_type,
+	       rec->event.message_type, rec->interface[0] ? rec->interface : "-",
+	       rec->event.nl_protocol, rec->event.nl_msg_type, rec->event.nl_seq,
+	       rec->event.nl_pid, rec->event.raw_len);
+	fflush(stdout);
+	
+	if (++*count == limit)
+		atomic_store(&stop, true);
+	pthread_mutex_unlock(&print_lock);
+}
+
+int main(int argc, char **argv)
+{
+	struct event_collector_config config = { .fn = on_event };
+	struct event_collector_stats stats;
+	struct event_collector *collector;
+	uint64_t count = 0;
+	int opt;
+	
+	while ((opt = getopt(argc, argv, "b:p:w:c:")) != -1) {
+		switch (opt) {
+		case 'b':
+			config.bind_addr = optarg;
+			break;
+		case 'p':
+			config.port = (uint16_t)atoi(optarg);
+			break;
+		case 'w':
+			config.workers = (unsigned int)atoi(optarg);
+			break;
+		case 'c':
+			limit = strtoull(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-b address] [-p port] [-w workers] [-c count]\n", argv[0]);
+			return 2;
+		}
+	}
+	
+	config.ctx = &count;
+	collector = event_collector_create(&config);
+	if (!collector) {
+		fprintf(stderr, "cannot listen on port %u\n",
+		        config.port ? config.port : EVENT_STREAM_PORT);
+		return 1;
+	}
+	
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	while (!atomic_load(&stop))
+		usleep(100000);
+	
+	event_collector_get_stats(collector, &stats);
+	event_collector_destroy(collector);
+	fprintf(stderr, "%" PRIu64 " events, %" PRIu64 " batches, %" PRIu64 " duplicates,"
+	        " %" PRIu64 " bytes in, %" PRIu64 " decoded, %u nodes\n",
+	        stats.events, stats.batches, stats.duplicates, stats.bytes_in,
+	        stats.bytes_raw, stats.nodes);
+	return 0;
+}
@@ -0,0 +1,256 @@
+/*
+ * nlmon_ctl - Talk to a running nlmon over its control socket (nlmon -K)
+ *
+ * Usage:
+ *   nlmon_ctl [-s socket] [-t type] [-i interface] [-g text] [-n n] <command>
+ *
+ *   -s socket     Control socket (default CLI_CONTROL_DEFAULT_PATH)
+ *   -t type       query: event type substring
+ *   -i interface  query: interface
+ *   -g text       query: message substring
+ *   -n n          query: newest n events (default all kept)
+ *
+ * Commands:
+ *   stats                 Print the daemon's counters
+ *   filters               List the named filters
+ *   add <name> <expr>     Add a filter, or replace its expression
+ *   disable <name> <expr> Add a filter disabled
+ *   remove <name>         Remove a filter
+ *   tail [filter]         Follow events, those matching filter if given
+ *   query                 Print the recent events the daemon kept
+ *   attach                Run the interactive CLI on the daemon's events
+ *                         (built with ENABLE_CLI)
+ */
+
+#include "cli_control.h"
+#ifdef ENABLE_CLI
+#include "cli_integration.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#define USAGE "Usage: %s [-s socket] [-t type] [-i interface] [-g text] [-n n] " \
+              "stats|filters|add|disable|remove|tail|query|attach [args]\n"
+
+static int fail(const char *what, int status)
+{
+	fprintf(stderr, "%s: %s\n", what, strerror(-status));
+	return 1;
+}
+
+static void print_event(const struct cli_control_event *ev)
+{
+	if (ev->missed)
+		printf("... %" PRIu64 " events missed\n", ev->missed);
+	printf("%s %-8s %-16s %.*s\n", ev->timestamp, ev->event_type,
+	       ev->interface[0] ? ev->interface : "-", (int)sizeof(ev->message), ev->message);
+}
+
+static int cmd_stats(int fd)
+{
+	struct cli_control_stats st;
+	int status;
+	
+	memset(&st, 0, sizeof(st));
+	status = cli_control_call(fd, CLI_CONTROL_STATS, NULL, 0, &st, sizeof(st));
+	if (status < 0)
+		return fail("stats", status);
+	
+	printf("published:  %" PRIu64 "\n", st.published);
+	printf("  link:     %" PRIu64 "\n", st.link_events);
+	printf("  route:    %" PRIu64 "\n", st.route_events);
+	printf("  addr:     %" PRIu64 "\n", st.addr_events);
+	printf("  neigh:    %" PRIu64 "\n", st.neigh_events);
+	printf("  rule:     %" PRIu64 "\n", st.rule_events);
+	printf("missed:     %" PRIu64 "\n", st.missed);
+	printf("dropped:    %" PRIu64 "\n", st.dropped);
+	printf("clients:    %u (%u subscribed)\n", st.clients, st.subscribers);
+	printf("filters:    %u\n", st.filters);
+	if (st.have_bus) {
+		printf("processed:  %" PRIu64 " (%" PRIu64 " dropped, %" PRIu64 " queued)\n",
+		       st.events_processed, st.events_dropped, st.queue_size);
+		printf("netlink:    %" PRIu64 " (%" PRIu64 " dropped)\n",
+		       st.netlink_messages, st.netlink_dropped);
+	}
+	return 0;
+}
+
+/* Read the packets of a listing up to its END */
+static int read_listing(int fd, uint32_t id, bool filters)
+{
+	union {
+		struct cli_control_filter filter;
+		struct cli_control_event event;
+	} item;
+	struct cli_control_hdr hdr;
+	ssize_t n;
+	
+	for (;;) {
+		memset(&item, 0, sizeof(item));
+		n = cli_control_recv(fd, &hdr, &item, sizeof(item), -1);
+		if (n < 0)
+			return fail("recv", -errno);
+		if (hdr.id != id)
+			continue;
+		if (hdr.status < 0)
+			return fail(filters ? "filters" : "query", hdr.status);
+		if (hdr.type == CLI_CONTROL_END)
+			return 0;
+	
+		if (filters && hdr.type == CLI_CONTROL_FILTER) {
+			item.filter.name[sizeof(item.filter.name) - 1] = '\0';
+			item.filter.expression[sizeof(item.filter.expression) - 1] = '\0';
+			printf("%-20s %-8s %10" PRIu64 " %10" PRIu64 "  %s\n", item.filter.name,
+			       item.filter.enabled ? "enabled" : "disabled", item.filter.evaluations,
+			       item.filter.matches, item.filter.expression);
+		} else if (!filters && hdr.type == CLI_CONTROL_EVENT) {
+			print_event(&item.event);
+		}
+	}
+}
+
+static int cmd_add(int fd, const char *name, const char *expression, bool enabled)
+{
+	struct cli_control_filter filter;
+	char error[CLI_CONTROL_MAX_PACKET];
+	int status;
+	
+	memset(&filter, 0, sizeof(filter));
+	if (strlen(name) >= sizeof(filter.name) || strlen(expression) >= sizeof(filter.expression))
+		return fail(name, -ENAMETOOLONG);
+	strcpy(filter.name, name);
+	strcpy(filter.expression, expression);
+	filter.enabled = enabled;
+	
+	memset(error, 0, sizeof(error));
+	status = cli_control_call(fd, CLI_CONTROL_FILTER_ADD, &filter, sizeof(filter),
+	                          error, sizeof(error) - 1);
+	if (status == -EINVAL && error[0]) {
+		fprintf(stderr, "%s: %s\n", name, error);
+		return 1;
+	}
+	return status < 0 ? fail(name, status) : 0;
+}
+
+static int cmd_remove(int fd, const char *name)
+{
+	struct cli_control_filter filter;
+	int status;
+	
+	memset(&filter, 0, sizeof(filter));
+	snprintf(filter.name, sizeof(filter.name), "%s", name);
+	status = cli_control_call(fd, CLI_CONTROL_FILTER_REMOVE, &filter, sizeof(filter), NULL, 0);
+	return status < 0 ? fail(name, status) : 0;
+}
+
+static int cmd_tail(int fd, const char *filter_name)
+{
+	struct cli_control_filter filter;
+	struct cli_control_event ev;
+	struct cli_control_hdr hdr;
+	int status;
+	ssize_t n;
+	
+	memset(&filter, 0, sizeof(filter));
+	if (filter_name)
+		snprintf(filter.name, sizeof(filter.name), "%s", filter_name);
+	status = cli_control_call(fd, CLI_CONTROL_SUBSCRIBE, &filter, sizeof(filter), NULL, 0);
+	if (status < 0)
+		return fail(filter_name ? filter_name : "subscribe", status);
+	
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	for (;;) {
+		memset(&ev, 0, sizeof(ev));
+		n = cli_control_recv(fd, &hdr, &ev, sizeof(ev), -1);
+		if (n < 0)
+			return errno == ECONNRESET ? 0 : fail("recv", -errno);
+		if (hdr.type == CLI_CONTROL_EVENT && (size_t)n == sizeof(ev))
+			print_event(&ev);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = CLI_CONTROL_DEFAULT_PATH;
+	struct cli_control_query query;
+	const char *cmd;
+	int opt, fd, ret;
+	
+	memset(&query, 0, sizeof(query));
+	
+	while ((opt = getopt(argc, argv, "s:t:i:g:n:")) != -1) {
+		switch (opt) {
+		case 's':
+			path = optarg;
+			break;
+		case 't':
+			snprintf(query.event_type, sizeof(query.event_type), "%s", optarg);
+			break;
+		case 'i':
+			snprintf(query.interface, sizeof(query.interface), "%s", optarg);
+			break;
+		case 'g':
+			snprintf(query.text, sizeof(query.text), "%s", optarg);
+			break;
+		case 'n':
+			query.max_results = (uint32_t)strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, USAGE, argv[0]);
+			return 2;
+		}
+	}
+	
+	if (optind >= argc) {
+		fprintf(stderr, USAGE, argv[0]);
+		return 2;
+	}
+	cmd = argv[optind++];
+	
+	if (!strcmp(cmd, "attach")) {
+#ifdef ENABLE_CLI
+		if (cli_enhanced_attach(path) < 0) {
+			fprintf(stderr, "%s: %s\n", path, strerror(errno));
+			return 1;
+		}
+		return 0;
+#else
+		fprintf(stderr, "attach: built without ENABLE_CLI\n");
+		return 1;
+#endif
+	}
+	
+	fd = cli_control_connect(path);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", path,
+		        errno == EPROTONOSUPPORT ? "not an nlmon control socket of this version" :
+		        strerror(errno));
+		return 1;
+	}
+	
+	if (!strcmp(cmd, "stats")) {
+		ret = cmd_stats(fd);
+	} else if (!strcmp(cmd, "filters")) {
+		ret = cli_control_send(fd, CLI_CONTROL_FILTER_LIST, 1, NULL, 0) < 0 ?
+		      fail("filters", -errno) : read_listing(fd, 1, true);
+	} else if ((!strcmp(cmd, "add") || !strcmp(cmd, "disable")) && optind + 2 == argc) {
+		ret = cmd_add(fd, argv[optind], argv[optind + 1], cmd[0] == 'a');
+	} else if (!strcmp(cmd, "remove") && optind + 1 == argc) {
+		ret = cmd_remove(fd, argv[optind]);
+	} else if (!strcmp(cmd, "tail") && optind + 1 >= argc) {
+		ret = cmd_tail(fd, optind < argc ? argv[optind] : NULL);
+	} else if (!strcmp(cmd, "query")) {
+		ret = cli_control_send(fd, CLI_CONTROL_QUERY, 1, &query, sizeof(query)) < 0 ?
+		      fail("query", -errno) : read_listing(fd, 1, false);
+	} else {
+		fprintf(stderr, USAGE, argv[0]);
+		ret = 2;
+	}
+	
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,112 @@
+/*
+ * nlmon_profile - Capture a CPU profile of a running nlmon
+ *
+ * Usage:
+ *   nlmon_profile [-s seconds] [-f hz] [-o file] <host[:port] | url>
+ *
+ *   -s  Length of the capture (default 10)
+ *   -f  Samples per CPU second (default 99)
+ *   -o  Write the folded stacks to file instead of stdout
+ *
+ * The output is folded stacks, e.g. for flamegraph.pl:
+ *   nlmon_profile -s 30 router:8080 | flamegraph.pl > nlmon.svg
+ */
+
+#include <curl/curl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define USAGE "Usage: %s [-s seconds] [-f hz] [-o file] <host[:port] | url>\n"
+
+static size_t write_out(char *data, size_t size, size_t nmemb, void *userdata)
+{
+	return fwrite(data, size, nmemb, userdata);
+}
+
+int main(int argc, char **argv)
+{
+	const char *output = NULL, *target;
+	unsigned long seconds = 10, hz = 0;
+	char url[1024], error[CURL_ERROR_SIZE] = "";
+	FILE *out = stdout;
+	CURL *curl;
+	CURLcode res;
+	long status = 0;
+	int opt, ret = 1;
+	
+	while ((opt = getopt(argc, argv, "s:f:o:")) != -1) {
+		switch (opt) {
+		case 's':
+			seconds = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			hz = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			fprintf(stderr, USAGE, argv[0]);
+			return 2;
+		}
+	}
+	
+	if (optind != argc - 1 || !seconds) {
+		fprintf(stderr, USAGE, argv[0]);
+		return 2;
+	}
+	
+	/* A bare host gets the scheme and the endpoint */
+	target = argv[optind];
+	if (strstr(target, "://"))
+		snprintf(url, sizeof(url), "%s%sseconds=%lu&hz=%lu", target,
+		         strchr(target, '?') ? "&" : "?", seconds, hz);
+	else
+		snprintf(url, sizeof(url), "http://%s/api/debug/profile?seconds=%lu&hz=%lu",
+		         target, seconds, hz);
+	
+	if (output) {
+		out = fopen(output, "w");
+		if (!out) {
+			perror(output);
+			return 1;
+		}
+	}
+	
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+	curl = curl_easy_init();
+	if (!curl) {
+		fprintf(stderr, "Failed to initialize libcurl\n");
+		goto out;
+	}
+	
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_out);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, out);
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error);
+	curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+	/* The server answers once the capture is over */
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)seconds + 60);
+	
+	fprintf(stderr, "Profiling for %lu seconds...\n", seconds);
+	res = curl_easy_perform(curl);
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+	curl_easy_cleanup(curl);
+	
+	if (res != CURLE_OK) {
+		fprintf(stderr, "%s: %s\n", url, status == 409 ? "a profile is already running" :
+		        error[0] ? error : curl_easy_strerror(res));
+		goto out;
+	}
+	ret = 0;
+	
+out:
+	curl_global_cleanup();
+	if (out != stdout && fclose(out) != 0 && !ret) {
+		perror(output);
+		ret = 1;
+	}
+	return ret;
+}
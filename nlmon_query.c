@@ -0,0 +1,156 @@
+/*
+ * nlmon_query - Query the events of an nlmon segment log
+ *
+ * Usage:
+ *   nlmon_query [options] <log directory>
+ *
+ *   -f expr   Filter expression
+ *   -s secs   First timestamp, seconds since the epoch
+ *   -e secs   Last timestamp, seconds since the epoch
+ *   -c cols   Columns printed, comma separated (default all)
+ *   -g cols   Count events grouped by these columns instead
+ *   -b secs   Width of the timestamp groups
+ *   -k n      Keep the n largest groups
+ *   -n n      Rows printed at most (default 1000)
+ *   -j n      Worker threads (default 4)
+ *   -t ms     Give up after ms milliseconds (default 10000)
+ *   -m MB     Give up past MB megabytes of rows and groups (default 64)
+ *
+ * Columns are timestamp, sequence, event_type, message_type and
+ * interface. The log is opened the way the daemon opens it, so query a
+ * log the daemon is not writing, or a copy of its directory.
+ */
+
+#include "storage_query.h"
+#include "storage_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#define USAGE "Usage: %s [-f expr] [-s secs] [-e secs] [-c cols] [-g cols] [-b secs] " \
+              "[-k n] [-n n] [-j n] [-t ms] [-m MB] <log directory>\n"
+
+static void print_row(const struct query_row *row, uint32_t columns, bool count)
+{
+	const char *sep = "";
+	
+	if (columns & QUERY_COL_BIT(QUERY_COL_TIMESTAMP)) {
+		printf("%" PRIu64 ".%09" PRIu64, (uint64_t)(row->timestamp / 1000000000ULL),
+		       (uint64_t)(row->timestamp % 1000000000ULL));
+		sep = " ";
+	}
+	if (columns & QUERY_COL_BIT(QUERY_COL_SEQUENCE)) {
+		printf("%sseq=%" PRIu64, sep, row->sequence);
+		sep = " ";
+	}
+	if (columns & QUERY_COL_BIT(QUERY_COL_EVENT_TYPE)) {
+		printf("%stype=%u", sep, row->event_type);
+		sep = " ";
+	}
+	if (columns & QUERY_COL_BIT(QUERY_COL_MESSAGE_TYPE)) {
+		printf("%smsg_type=%u", sep, row->message_type);
+		sep = " ";
+	}
+	if (columns & QUERY_COL_BIT(QUERY_COL_INTERFACE)) {
+		printf("%sinterface=%s", sep, row->interface[0] ? row->interface : "-");
+		sep = " ";
+	}
+	if (count)
+		printf("%scount=%" PRIu64, sep, row->count);
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct storage_log_config config = {0};
+	struct storage_query query = {0};
+	struct storage_query_result result;
+	struct storage_log *log;
+	const char *group = NULL, *columns = NULL;
+	int opt;
+	
+	while ((opt = getopt(argc, argv, "f:s:e:c:g:b:k:n:j:t:m:")) != -1) {
+		switch (opt) {
+		case 'f':
+			query.filter = optarg;
+			break;
+		case 's':
+			query.start_time = strtoull(optarg, NULL, 10) * 1000000000ULL;
+			break;
+		case 'e':
+			query.end_time = strtoull(optarg, NULL, 10) * 1000000000ULL;
+			break;
+		case 'c':
+			columns = optarg;
+			break;
+		case 'g':
+			group = optarg;
+			break;
+		case 'b':
+			query.bucket_ns = strtoull(optarg, NULL, 10) * 1000000000ULL;
+			break;
+		case 'k':
+			query.top_k = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			query.limit = strtoul(optarg, NULL, 10);
+			break;
+		case 'j':
+			query.threads = (unsigned int)strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			query.timeout_ms = (unsigned int)strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			query.max_memory = strtoul(optarg, NULL, 10) * 1024 * 1024;
+			break;
+		default:
+			fprintf(stderr, USAGE, argv[0]);
+			return 2;
+		}
+	}
+	
+	if (optind != argc - 1) {
+		fprintf(stderr, USAGE, argv[0]);
+		return 2;
+	}
+	
+	if (!storage_query_parse_columns(columns, &query.columns) ||
+	    !storage_query_parse_columns(group, &query.group_by)) {
+		fprintf(stderr, "Unknown column, expected timestamp, sequence, event_type, "
+		        "message_type or interface\n");
+		return 2;
+	}
+	
+	config.dir = argv[optind];
+	log = storage_log_open(&config);
+	if (!log) {
+		fprintf(stderr, "%s: cannot open segment log\n", argv[optind]);
+		return 1;
+	}
+	
+	if (storage_query_run(log, NULL, &query, &result) != QUERY_OK) {
+		fprintf(stderr, "%s%s%s\n", storage_query_status_str(result.status),
+		        result.error[0] ? ": " : "", result.error);
+		storage_log_close(log);
+		return 1;
+	}
+	
+	for (size_t i = 0; i < result.num_rows; i++) {
+		if (query.group_by)
+			print_row(&result.rows[i], query.group_by, true);
+		else
+			print_row(&result.rows[i], query.columns ? query.columns : QUERY_COL_ALL, false);
+	}
+	
+	fprintf(stderr, "%zu rows%s, %" PRIu64 " events scanned, %" PRIu64 " matched, "
+	        "%zu partitions, %" PRIu64 " us\n", result.num_rows,
+	        result.truncated ? " (truncated)" : "", result.scanned, result.matched,
+	        result.partitions, result.elapsed_us);
+	
+	storage_query_result_free(&result);
+	storage_log_close(log);
+	return 0;
+}
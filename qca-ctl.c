@@ -12,6 +12,10 @@
  *   qca-ctl wlan0 set-roam-rssi 70
  *   qca-ctl wlan0 vendor-cmd 0x0f
  *   qca-ctl wlan0 list-commands
+ *   qca-ctl -i 1 wlan0,wlan1,wlan2 get-stats
+ *
+ * Commands to several interfaces are pipelined on one control session
+ * and take a single round trip, see qca_session_submit().
  */
 
 #include <stdio.h>
@@ -25,16 +29,11 @@
 #include <netlink/genl/ctrl.h>
 #include <linux/nl80211.h>
 
-/* QCA Vendor OUI */
-#define QCA_NL80211_VENDOR_ID  0x001374
+#include "qca_control.h"
 
-/* Common QCA Vendor Subcommands */
+/* Further QCA Vendor Subcommands */
 #define QCA_NL80211_VENDOR_SUBCMD_LL_STATS_SET          14
-#define QCA_NL80211_VENDOR_SUBCMD_LL_STATS_GET          15
-#define QCA_NL80211_VENDOR_SUBCMD_LL_STATS_CLR          16
 #define QCA_NL80211_VENDOR_SUBCMD_GET_LOGGER_FEATURE    17
-#define QCA_NL80211_VENDOR_SUBCMD_GET_WIFI_INFO         61
-#define QCA_NL80211_VENDOR_SUBCMD_ROAM                  64
 #define QCA_NL80211_VENDOR_SUBCMD_SET_WIFI_CONFIG       74
 #define QCA_NL80211_VENDOR_SUBCMD_PACKET_FILTER         83
 #define QCA_NL80211_VENDOR_SUBCMD_GET_BUS_SIZE          139
@@ -51,13 +50,18 @@ enum qca_wlan_vendor_attr {
 	QCA_WLAN_VENDOR_ATTR_ROAM_RSSI_THRESHOLD = 10,
 };
 
+/* Interfaces one command line addresses */
+#define MAX_INTERFACES  QCA_SESSION_MAX_PENDING
+
 /* Global state */
 static struct {
-	struct nl_sock *sock;
-	int nl80211_id;
-	int ifindex;
+	struct qca_session *session;
+	const char *ifnames[MAX_INTERFACES];
+	int errors[MAX_INTERFACES];
+	int count;
 	int verbose;
 	int wait_for_response;
+	unsigned int interval;
 } g_state;
 
 /* Response handler */
@@ -72,7 +76,13 @@ static int response_handler(struct nl_msg *msg, void *arg)
 	if (tb[NL80211_ATTR_VENDOR_DATA]) {
 		void *data = nla_data(tb[NL80211_ATTR_VENDOR_DATA]);
 		int len = nla_len(tb[NL80211_ATTR_VENDOR_DATA]);
+		char ifname[IF_NAMESIZE] = "?";
 		
+		if (g_state.count > 1) {
+			if (tb[NL80211_ATTR_IFINDEX])
+				if_indextoname(nla_get_u32(tb[NL80211_ATTR_IFINDEX]), ifname);
+			printf("%s: ", ifname);
+		}
 		printf("Response received (%d bytes):\n", len);
 		
 		/* Hex dump */
@@ -88,161 +98,81 @@ static int response_handler(struct nl_msg *msg, void *arg)
 	return NL_OK;
 }
 
-/* Error handler */
-static int error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg)
+/* Split a comma separated interface list */
+static int parse_interfaces(char *list)
 {
-	int *ret = arg;
-	*ret = err->error;
+	char *save = NULL;
 	
-	if (err->error < 0)
-		fprintf(stderr, "Error: %s (%d)\n", strerror(-err->error), err->error);
-	
-	return NL_STOP;
-}
-
-/* Finish handler */
-static int finish_handler(struct nl_msg *msg, void *arg)
-{
-	int *ret = arg;
-	*ret = 0;
-	return NL_SKIP;
-}
-
-/* ACK handler */
-static int ack_handler(struct nl_msg *msg, void *arg)
-{
-	int *ret = arg;
-	*ret = 0;
-	return NL_STOP;
+	for (char *name = strtok_r(list, ",", &save); name;
+	     name = strtok_r(NULL, ",", &save)) {
+		if (g_state.count == MAX_INTERFACES) {
+			fprintf(stderr, "At most %d interfaces\n", MAX_INTERFACES);
+			return -1;
+		}
+		g_state.ifnames[g_state.count++] = name;
+	}
+	return g_state.count > 0 ? 0 : -1;
 }
 
 /* Initialize netlink */
-static int init_nl80211(const char *ifname)
+static int init_nl80211(void)
 {
-	int ret;
-	
-	/* Allocate socket */
-	g_state.sock = nl_socket_alloc();
-	if (!g_state.sock) {
-		fprintf(stderr, "Failed to allocate netlink socket\n");
-		return -1;
-	}
-	
-	/* Connect to generic netlink */
-	ret = genl_connect(g_state.sock);
-	if (ret < 0) {
-		fprintf(stderr, "Failed to connect to generic netlink: %s\n",
-		        nl_geterror(ret));
-		nl_socket_free(g_state.sock);
-		return -1;
-	}
-	
-	/* Resolve nl80211 family */
-	g_state.nl80211_id = genl_ctrl_resolve(g_state.sock, "nl80211");
-	if (g_state.nl80211_id < 0) {
-		fprintf(stderr, "nl80211 not found: %s\n",
-		        nl_geterror(g_state.nl80211_id));
-		nl_socket_free(g_state.sock);
-		return -1;
-	}
-	
-	/* Get interface index */
-	g_state.ifindex = if_nametoindex(ifname);
-	if (g_state.ifindex == 0) {
-		fprintf(stderr, "Interface %s not found: %s\n",
-		        ifname, strerror(errno));
-		nl_socket_free(g_state.sock);
+	g_state.session = qca_session_open();
+	if (!g_state.session) {
+		fprintf(stderr, "Failed to open nl80211 control session\n");
 		return -1;
 	}
 	
 	if (g_state.verbose)
-		printf("Initialized: nl80211_id=%d ifindex=%d\n",
-		       g_state.nl80211_id, g_state.ifindex);
+		printf("Initialized: %d interface(s)\n", g_state.count);
 	
 	return 0;
 }
 
-/* Send vendor command */
-static int send_vendor_command(uint32_t subcmd, const void *data, size_t data_len)
+/* Report the commands that failed, returns their number */
+static int report_errors(int failed)
 {
-	struct nl_msg *msg;
-	struct nl_cb *cb;
-	int ret = -1;
-	int err;
-	
-	/* Allocate message */
-	msg = nlmsg_alloc();
-	if (!msg) {
-		fprintf(stderr, "Failed to allocate message\n");
+	if (failed < 0) {
+		fprintf(stderr, "Error: netlink receive failed\n");
 		return -1;
 	}
 	
-	/* Build message */
-	genlmsg_put(msg, 0, 0, g_state.nl80211_id, 0, 0,
-	            NL80211_CMD_VENDOR, 0);
-	
-	nla_put_u32(msg, NL80211_ATTR_IFINDEX, g_state.ifindex);
-	nla_put_u32(msg, NL80211_ATTR_VENDOR_ID, QCA_NL80211_VENDOR_ID);
-	nla_put_u32(msg, NL80211_ATTR_VENDOR_SUBCMD, subcmd);
-	
-	if (data && data_len > 0)
-		nla_put(msg, NL80211_ATTR_VENDOR_DATA, data_len, data);
-	
-	/* Set up callback */
-	cb = nl_cb_alloc(NL_CB_DEFAULT);
-	if (!cb) {
-		fprintf(stderr, "Failed to allocate callback\n");
-		nlmsg_free(msg);
-		return -1;
+	for (int i = 0; i < g_state.count && failed > 0; i++) {
+		if (g_state.errors[i] < 0)
+			fprintf(stderr, "%s: Error: %s (%d)\n", g_state.ifnames[i],
+			        strerror(-g_state.errors[i]), g_state.errors[i]);
 	}
-	
-	err = 1;
-	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, response_handler, NULL);
-	nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, finish_handler, &err);
-	nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, &err);
-	nl_cb_err(cb, NL_CB_CUSTOM, error_handler, &err);
-	
-	/* Send message */
-	ret = nl_send_auto(g_state.sock, msg);
-	if (ret < 0) {
-		fprintf(stderr, "Failed to send message: %s\n", nl_geterror(ret));
-		goto out;
+	return failed;
+}
+
+/* Send vendor command to every interface, in one round trip */
+static int send_vendor_command(uint32_t subcmd, const void *data, size_t data_len)
+{
+	int unsent = 0;
+	
+	for (int i = 0; i < g_state.count; i++) {
+		if (qca_session_submit(g_state.session, g_state.ifnames[i], subcmd,
+		                       data, data_len,
+		                       g_state.wait_for_response ? response_handler : NULL,
+		                       NULL, &g_state.errors[i]) < 0)
+			unsent++;
 	}
 	
 	if (g_state.verbose)
-		printf("Sent vendor command: subcmd=0x%x data_len=%zu\n",
-		       subcmd, data_len);
-	
-	/* Wait for response if requested */
-	if (g_state.wait_for_response) {
-		while (err > 0)
-			nl_recvmsgs(g_state.sock, cb);
-	}
-	
-	ret = err;
+		printf("Sent vendor command: subcmd=0x%x data_len=%zu to %d interface(s)\n",
+		       subcmd, data_len, g_state.count - unsent);
 	
-out:
-	nl_cb_put(cb);
-	nlmsg_free(msg);
-	return ret;
+	return report_errors(qca_session_wait(g_state.session) + unsent);
 }
 
 /* Command: Get link layer statistics */
 static int cmd_get_stats(void)
 {
-	struct {
-		uint32_t req_id;
-		uint32_t req_mask;
-	} __attribute__((packed)) stats_req = {
-		.req_id = 1,
-		.req_mask = 0x7  /* Radio + Iface + Peer */
-	};
-	
 	printf("Getting link layer statistics...\n");
-	g_state.wait_for_response = 1;
 	
-	return send_vendor_command(QCA_NL80211_VENDOR_SUBCMD_LL_STATS_GET,
-	                           &stats_req, sizeof(stats_req));
+	return report_errors(qca_session_get_link_stats(g_state.session, g_state.ifnames,
+	                                                g_state.count, response_handler,
+	                                                NULL, g_state.errors));
 }
 
 /* Command: Get WiFi info */
@@ -375,26 +305,63 @@ static void cmd_list_commands(void)
 	printf("  qca-ctl wlan0 vendor-cmd 0x40 01020304\n");
 }
 
+/* Execute one command, args are what follows it */
+static int run_command(const char *prog, const char *command, int argc, char *argv[])
+{
+	if (strcmp(command, "get-stats") == 0)
+		return cmd_get_stats();
+	if (strcmp(command, "get-info") == 0)
+		return cmd_get_info();
+	if (strcmp(command, "get-logger") == 0)
+		return cmd_get_logger_features();
+	if (strcmp(command, "clear-stats") == 0)
+		return cmd_clear_stats();
+	if (strcmp(command, "set-roam-rssi") == 0) {
+		if (argc < 1) {
+			fprintf(stderr, "Missing RSSI threshold value\n");
+			return -1;
+		}
+		return cmd_set_roam_rssi(atoi(argv[0]));
+	}
+	if (strcmp(command, "vendor-cmd") == 0) {
+		if (argc < 1) {
+			fprintf(stderr, "Missing vendor subcommand\n");
+			return -1;
+		}
+		return cmd_vendor_raw(strtoul(argv[0], NULL, 0), argc > 1 ? argv[1] : NULL);
+	}
+	
+	fprintf(stderr, "Unknown command: %s\n", command);
+	fprintf(stderr, "Run '%s %s list-commands' for available commands\n",
+	        prog, g_state.ifnames[0]);
+	return -1;
+}
+
 /* Usage */
 static void usage(const char *prog)
 {
-	printf("Usage: %s [options] <interface> <command> [args]\n\n", prog);
+	printf("Usage: %s [options] <interface>[,<interface>...] <command> [args]\n\n", prog);
 	printf("Options:\n");
+	printf("  -i <secs>  Repeat the command every <secs> seconds on one session\n");
 	printf("  -v         Verbose output\n");
 	printf("  -h         Show this help\n");
 	printf("\n");
+	printf("Commands to several interfaces are sent together and take one round trip.\n");
 	printf("Run '%s <interface> list-commands' for available commands\n", prog);
 }
 
 /* Main */
 int main(int argc, char *argv[])
 {
-	const char *ifname, *command;
+	const char *command;
 	int opt, ret = 0;
 	
 	/* Parse options */
-	while ((opt = getopt(argc, argv, "vh")) != -1) {
+	while ((opt = getopt(argc, argv, "i:vh")) != -1) {
 		switch (opt) {
+		case 'i':
+			g_state.interval = strtoul(optarg, NULL, 0);
+			break;
 		case 'v':
 			g_state.verbose = 1;
 			break;
@@ -408,12 +375,11 @@ int main(int argc, char *argv[])
 	}
 	
 	/* Check arguments */
-	if (optind + 2 > argc) {
+	if (optind + 2 > argc || parse_interfaces(argv[optind]) < 0) {
 		usage(argv[0]);
 		return 1;
 	}
 	
-	ifname = argv[optind];
 	command = argv[optind + 1];
 	
 	/* Special case: list-commands doesn't need netlink */
@@ -423,50 +389,24 @@ int main(int argc, char *argv[])
 	}
 	
 	/* Initialize netlink */
-	if (init_nl80211(ifname) < 0)
+	if (init_nl80211() < 0)
 		return 1;
 	
-	/* Execute command */
-	if (strcmp(command, "get-stats") == 0) {
-		ret = cmd_get_stats();
-	} else if (strcmp(command, "get-info") == 0) {
-		ret = cmd_get_info();
-	} else if (strcmp(command, "get-logger") == 0) {
-		ret = cmd_get_logger_features();
-	} else if (strcmp(command, "clear-stats") == 0) {
-		ret = cmd_clear_stats();
-	} else if (strcmp(command, "set-roam-rssi") == 0) {
-		if (optind + 3 > argc) {
-			fprintf(stderr, "Missing RSSI threshold value\n");
-			ret = 1;
-		} else {
-			int rssi = atoi(argv[optind + 2]);
-			ret = cmd_set_roam_rssi(rssi);
-		}
-	} else if (strcmp(command, "vendor-cmd") == 0) {
-		if (optind + 3 > argc) {
-			fprintf(stderr, "Missing vendor subcommand\n");
-			ret = 1;
-		} else {
-			uint32_t subcmd = strtoul(argv[optind + 2], NULL, 0);
-			const char *hex_data = (optind + 4 <= argc) ? argv[optind + 3] : NULL;
-			ret = cmd_vendor_raw(subcmd, hex_data);
-		}
-	} else {
-		fprintf(stderr, "Unknown command: %s\n", command);
-		fprintf(stderr, "Run '%s %s list-commands' for available commands\n",
-		        argv[0], ifname);
-		ret = 1;
+	/* Execute command, repeatedly on the same session with -i */
+	for (;;) {
+		ret = run_command(argv[0], command, argc - optind - 2, argv + optind + 2);
+		if (ret < 0 || g_state.interval == 0)
+			break;
+		sleep(g_state.interval);
 	}
 	
 	/* Cleanup */
-	if (g_state.sock)
-		nl_socket_free(g_state.sock);
+	qca_session_close(g_state.session);
 	
 	if (ret == 0)
 		printf("Command completed successfully\n");
 	else if (ret > 0)
-		printf("Command completed with warnings\n");
+		printf("Command failed on %d interface(s)\n", ret);
 	
-	return ret < 0 ? 1 : 0;
+	return ret == 0 ? 0 : 1;
 }
@@ -0,0 +1,597 @@
+/* cli_control.c - Control protocol server
+ *
+ * One thread polls the listening socket and the clients and, between
+ * requests, drains the feed the event thread publishes to: each record
+ * goes into the query history and out to the subscribers. Filtered
+ * subscriptions are matched by the publisher, which has the event, and
+ * reach this thread as a tag bit per client slot on the record.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "cli_control.h"
+#include "cli_feed.h"
+#include "filter_manager.h"
+#include "stats_bus.h"
+
+/* Longest wait for a client between drains of the feed */
+#define POLL_MS 10
+
+/* Longest wait for a client to make room for a response */
+#define SEND_WAIT_MS 200
+
+/* Records the publisher can get ahead of the server by */
+#define FEED_CAPACITY 4096
+
+/* Filters listed at most */
+#define MAX_LISTED_FILTERS 256
+
+struct control_client {
+    int fd;                     /* -1 for a free slot */
+    bool subscribed;
+    bool filtered;              /* Subscribed to sub_filter[slot] */
+    uint64_t missed;            /* Events lost since the last one sent */
+};
+
+struct cli_control_server {
+    struct cli_control_context ctx;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    int listen_fd;
+    pthread_t thread;
+    _Atomic bool stop;
+    
+    struct control_client clients[CLI_CONTROL_MAX_CLIENTS];
+    _Atomic uint32_t subscribers;
+    
+    /* Filter of each slot's filtered subscription, read by the publisher */
+    pthread_mutex_t filters_lock;
+    char sub_filter[CLI_CONTROL_MAX_CLIENTS][64];
+    uint32_t filtered;          /* Slots with a filter */
+    _Atomic bool any_filtered;
+    
+    struct cli_feed *feed;
+    uint64_t cursor;
+    uint64_t missed;
+    uint64_t dropped;
+    
+    /* Recent events, a ring */
+    struct cli_control_event *history;
+    size_t history_count;
+    size_t history_head;
+};
+
+/* Send a packet without blocking, or waiting a little for room if asked */
+static bool send_packet(int fd, uint16_t type, int16_t status, uint32_t id,
+                        const void *payload, size_t len, bool wait)
+{
+    struct cli_control_hdr hdr = {
+        .type = type,
+        .status = status,
+        .id = id,
+        .len = (uint32_t)len,
+    };
+    struct iovec iov[2] = {
+        { .iov_base = &hdr, .iov_len = sizeof(hdr) },
+        { .iov_base = (void *)payload, .iov_len = len },
+    };
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = len ? 2 : 1,
+    };
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+    
+    for (;;) {
+        if (sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0)
+            return true;
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN || !wait || poll(&pfd, 1, SEND_WAIT_MS) <= 0)
+            return false;
+        wait = false;
+    }
+}
+
+/* Publisher side */
+
+void cli_control_publish(struct cli_control_server *srv, struct nlmon_event *event,
+                         const char *event_type, const char *interface,
+                         const char *message)
+{
+    struct tm tm_buf, *tm_info;
+    char timestamp[32] = "";
+    uint64_t tags = 0;
+    time_t now;
+    
+    if (!srv)
+        return;
+    
+    if (event && srv->ctx.filter_mgr &&
+        atomic_load_explicit(&srv->any_filtered, memory_order_acquire)) {
+        pthread_mutex_lock(&srv->filters_lock);
+        for (int i = 0; i < CLI_CONTROL_MAX_CLIENTS; i++) {
+            if ((srv->filtered & (1u << i)) &&
+                filter_manager_eval(srv->ctx.filter_mgr, srv->sub_filter[i], event))
+                tags |= 1ull << i;
+        }
+        pthread_mutex_unlock(&srv->filters_lock);
+    }
+    
+    time(&now);
+    tm_info = localtime_r(&now, &tm_buf);
+    if (tm_info)
+        strftime(timestamp, sizeof(timestamp), "%H:%M:%S", tm_info);
+    
+    cli_feed_publish_tagged(srv->feed, tags, timestamp, event_type, interface, message, NULL);
+}
+
+bool cli_control_has_subscribers(struct cli_control_server *srv)
+{
+    return srv && atomic_load_explicit(&srv->subscribers, memory_order_relaxed) > 0;
+}
+
+/* Server thread */
+
+/* Set or clear the filter of a slot */
+static void set_sub_filter(struct cli_control_server *srv, int slot, const char *name)
+{
+    pthread_mutex_lock(&srv->filters_lock);
+    if (name && name[0]) {
+        snprintf(srv->sub_filter[slot], sizeof(srv->sub_filter[slot]), "%s", name);
+        srv->filtered |= 1u << slot;
+    } else {
+        srv->sub_filter[slot][0] = '\0';
+        srv->filtered &= ~(1u << slot);
+    }
+    atomic_store_explicit(&srv->any_filtered, srv->filtered != 0, memory_order_release);
+    pthread_mutex_unlock(&srv->filters_lock);
+}
+
+static void unsubscribe(struct cli_control_server *srv, int slot)
+{
+    struct control_client *client = &srv->clients[slot];
+    
+    if (!client->subscribed)
+        return;
+    
+    client->subscribed = false;
+    client->filtered = false;
+    set_sub_filter(srv, slot, NULL);
+    atomic_fetch_sub_explicit(&srv->subscribers, 1, memory_order_relaxed);
+}
+
+static void drop_client(struct cli_control_server *srv, int slot)
+{
+    struct control_client *client = &srv->clients[slot];
+    
+    unsubscribe(srv, slot);
+    close(client->fd);
+    client->fd = -1;
+}
+
+static void accept_client(struct cli_control_server *srv)
+{
+    int fd, slot;
+    
+    fd = accept4(srv->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0)
+        return;
+    
+    for (slot = 0; slot < CLI_CONTROL_MAX_CLIENTS; slot++) {
+        if (srv->clients[slot].fd < 0)
+            break;
+    }
+    if (slot == CLI_CONTROL_MAX_CLIENTS) {
+        close(fd);
+        return;
+    }
+    
+    memset(&srv->clients[slot], 0, sizeof(srv->clients[slot]));
+    srv->clients[slot].fd = fd;
+}
+
+static void handle_stats(struct cli_control_server *srv, struct cli_control_stats *stats)
+{
+    struct nlmon_stats_snapshot *snap;
+    struct cli_feed_stats feed;
+    
+    memset(stats, 0, sizeof(*stats));
+    
+    cli_feed_get_stats(srv->feed, &feed);
+    stats->published = feed.published;
+    stats->link_events = feed.link_events;
+    stats->route_events = feed.route_events;
+    stats->addr_events = feed.addr_events;
+    stats->neigh_events = feed.neigh_events;
+    stats->rule_events = feed.rule_events;
+    stats->missed = srv->missed;
+    stats->dropped = srv->dropped;
+    stats->subscribers = atomic_load_explicit(&srv->subscribers, memory_order_relaxed);
+    for (int i = 0; i < CLI_CONTROL_MAX_CLIENTS; i++)
+        stats->clients += srv->clients[i].fd >= 0;
+    if (srv->ctx.filter_mgr)
+        stats->filters = (uint32_t)filter_manager_list(srv->ctx.filter_mgr, NULL, 0);
+    
+    if (!srv->ctx.stats_bus)
+        return;
+    snap = malloc(sizeof(*snap));
+    if (snap && stats_bus_read(srv->ctx.stats_bus, snap)) {
+        stats->have_bus = 1;
+        if (snap->have & STATS_HAVE_EVENTS) {
+            stats->events_processed = snap->events.processed;
+            stats->events_dropped = snap->events.dropped;
+            stats->queue_size = snap->events.queue_size;
+        }
+        if (snap->have & STATS_HAVE_NETLINK) {
+            stats->netlink_messages = snap->netlink.total_messages_processed;
+            stats->netlink_dropped = snap->netlink.total_messages_dropped;
+        }
+    }
+    free(snap);
+}
+
+static bool handle_filter_list(struct cli_control_server *srv, int fd, uint32_t id)
+{
+    const char *names[MAX_LISTED_FILTERS];
+    size_t count;
+    
+    if (!srv->ctx.filter_mgr)
+        return send_packet(fd, CLI_CONTROL_END, -EOPNOTSUPP, id, NULL, 0, true);
+    
+    count = filter_manager_list(srv->ctx.filter_mgr, names, MAX_LISTED_FILTERS);
+    if (count > MAX_LISTED_FILTERS)
+        count = MAX_LISTED_FILTERS;
+    
+    for (size_t i = 0; i < count; i++) {
+        struct filter_entry *entry = filter_manager_get(srv->ctx.filter_mgr, names[i]);
+        struct cli_control_filter out;
+    
+        if (!entry)
+            continue;
+        memset(&out, 0, sizeof(out));
+        snprintf(out.name, sizeof(out.name), "%s", entry->name);
+        snprintf(out.expression, sizeof(out.expression), "%s", entry->expression);
+        out.enabled = entry->enabled;
+        out.evaluations = atomic_load_explicit(&entry->eval_count, memory_order_relaxed);
+        out.matches = atomic_load_explicit(&entry->match_count, memory_order_relaxed);
+        if (!send_packet(fd, CLI_CONTROL_FILTER, 0, id, &out, sizeof(out), true))
+            return false;
+    }
+    return send_packet(fd, CLI_CONTROL_END, 0, id, NULL, 0, true);
+}
+
+static bool handle_filter_add(struct cli_control_server *srv, int fd, uint32_t id,
+                              struct cli_control_filter *filter)
+{
+    struct filter_manager *mgr = srv->ctx.filter_mgr;
+    char error[256];
+    bool ok;
+    
+    if (!mgr)
+        return send_packet(fd, CLI_CONTROL_FILTER_ADD, -EOPNOTSUPP, id, NULL, 0, true);
+    
+    filter->name[sizeof(filter->name) - 1] = '\0';
+    filter->expression[sizeof(filter->expression) - 1] = '\0';
+    if (!filter->name[0])
+        return send_packet(fd, CLI_CONTROL_FILTER_ADD, -EINVAL, id, NULL, 0, true);
+    
+    error[0] = '\0';
+    if (!filter_manager_validate(mgr, filter->expression, error, sizeof(error)))
+        return send_packet(fd, CLI_CONTROL_FILTER_ADD, -EINVAL, id, error, strlen(error) + 1, true);
+    
+    /* Adding a name that exists replaces its expression */
+    if (filter_manager_get(mgr, filter->name))
+        ok = filter_manager_update(mgr, filter->name, filter->expression);
+    else
+        ok = filter_manager_add(mgr, filter->name, filter->expression, NULL);
+    if (ok && !filter->enabled)
+        ok = filter_manager_disable(mgr, filter->name);
+    else if (ok)
+        ok = filter_manager_enable(mgr, filter->name);
+    
+    return send_packet(fd, CLI_CONTROL_FILTER_ADD, ok ? 0 : -ENOMEM, id, NULL, 0, true);
+}
+
+static bool handle_subscribe(struct cli_control_server *srv, int slot, uint32_t id,
+                             struct cli_control_filter *filter)
+{
+    struct control_client *client = &srv->clients[slot];
+    
+    filter->name[sizeof(filter->name) - 1] = '\0';
+    if (filter->name[0] &&
+        (!srv->ctx.filter_mgr || !filter_manager_get(srv->ctx.filter_mgr, filter->name)))
+        return send_packet(client->fd, CLI_CONTROL_SUBSCRIBE, -ENOENT, id, NULL, 0, true);
+    
+    if (!client->subscribed)
+        atomic_fetch_add_explicit(&srv->subscribers, 1, memory_order_relaxed);
+    client->subscribed = true;
+    client->filtered = filter->name[0] != '\0';
+    client->missed = 0;
+    set_sub_filter(srv, slot, filter->name);
+    
+    return send_packet(client->fd, CLI_CONTROL_SUBSCRIBE, 0, id, NULL, 0, true);
+}
+
+static bool query_match(const struct cli_control_event *ev, const struct cli_control_query *q)
+{
+    if (ev->seq <= q->after_seq)
+        return false;
+    if (q->event_type[0] && !strstr(ev->event_type, q->event_type))
+        return false;
+    if (q->interface[0] && strcmp(ev->interface, q->interface) != 0)
+        return false;
+    if (q->text[0] && !strstr(ev->message, q->text))
+        return false;
+    return true;
+}
+
+/* The newest max_results matching events, oldest first */
+static bool handle_query(struct cli_control_server *srv, int fd, uint32_t id,
+                         struct cli_control_query *q)
+{
+    static size_t picked[CLI_CONTROL_HISTORY];
+    size_t count = 0, limit;
+    
+    q->event_type[sizeof(q->event_type) - 1] = '\0';
+    q->interface[sizeof(q->interface) - 1] = '\0';
+    q->text[sizeof(q->text) - 1] = '\0';
+    limit = q->max_results ? q->max_results : CLI_CONTROL_HISTORY;
+    
+    for (size_t i = 0; i < srv->history_count && count < limit; i++) {
+        size_t idx = (srv->history_head + CLI_CONTROL_HISTORY - 1 - i) % CLI_CONTROL_HISTORY;
+    
+        if (query_match(&srv->history[idx], q))
+            picked[count++] = idx;
+    }
+    
+    while (count > 0) {
+        if (!send_packet(fd, CLI_CONTROL_EVENT, 0, id, &srv->history[picked[--count]],
+                         sizeof(struct cli_control_event), true))
+            return false;
+    }
+    return send_packet(fd, CLI_CONTROL_END, 0, id, NULL, 0, true);
+}
+
+/* Answer one request, false to drop the client */
+static bool serve_client(struct cli_control_server *srv, int slot)
+{
+    struct control_client *client = &srv->clients[slot];
+    struct cli_control_hdr hdr_buf, *hdr = &hdr_buf;
+    union {
+        uint32_t version;
+        struct cli_control_filter filter;
+        struct cli_control_query query;
+    } body;
+    struct iovec iov[2] = {
+        { .iov_base = &hdr_buf, .iov_len = sizeof(hdr_buf) },
+        { .iov_base = &body, .iov_len = sizeof(body) },
+    };
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = 2,
+    };
+    struct cli_control_stats stats;
+    uint32_t version = CLI_CONTROL_VERSION;
+    ssize_t n;
+    
+    memset(&hdr_buf, 0, sizeof(hdr_buf));
+    memset(&body, 0, sizeof(body));
+    n = recvmsg(client->fd, &msg, MSG_DONTWAIT);
+    if (n < 0)
+        return errno == EAGAIN || errno == EINTR;
+    if (n < (ssize_t)sizeof(*hdr) || (msg.msg_flags & MSG_TRUNC) ||
+        hdr->len != (size_t)n - sizeof(*hdr))
+        return false;
+    
+    switch (hdr->type) {
+    case CLI_CONTROL_HELLO:
+        return send_packet(client->fd, CLI_CONTROL_HELLO,
+                           body.version == CLI_CONTROL_VERSION ? 0 : -EPROTONOSUPPORT,
+                           hdr->id, &version, sizeof(version), true);
+    case CLI_CONTROL_STATS:
+        handle_stats(srv, &stats);
+        return send_packet(client->fd, CLI_CONTROL_STATS, 0, hdr->id, &stats, sizeof(stats), true);
+    case CLI_CONTROL_FILTER_LIST:
+        return handle_filter_list(srv, client->fd, hdr->id);
+    case CLI_CONTROL_FILTER_ADD:
+        return handle_filter_add(srv, client->fd, hdr->id, &body.filter);
+    case CLI_CONTROL_FILTER_REMOVE:
+        body.filter.name[sizeof(body.filter.name) - 1] = '\0';
+        return send_packet(client->fd, CLI_CONTROL_FILTER_REMOVE,
+                           !srv->ctx.filter_mgr ? -EOPNOTSUPP :
+                           filter_manager_remove(srv->ctx.filter_mgr, body.filter.name) ?
+                           0 : -ENOENT, hdr->id, NULL, 0, true);
+    case CLI_CONTROL_SUBSCRIBE:
+        return handle_subscribe(srv, slot, hdr->id, &body.filter);
+    case CLI_CONTROL_UNSUBSCRIBE:
+        unsubscribe(srv, slot);
+        return send_packet(client->fd, CLI_CONTROL_UNSUBSCRIBE, 0, hdr->id, NULL, 0, true);
+    case CLI_CONTROL_QUERY:
+        return handle_query(srv, client->fd, hdr->id, &body.query);
+    default:
+        return send_packet(client->fd, hdr->type, -EOPNOTSUPP, hdr->id, NULL, 0, true);
+    }
+}
+
+/* Move published records into the history and out to the subscribers */
+static void drain_feed(struct cli_control_server *srv)
+{
+    struct cli_feed_record record;
+    uint64_t missed = srv->missed;
+    
+    while (cli_feed_next(srv->feed, &srv->cursor, &record, &srv->missed)) {
+        struct cli_control_event *ev = &srv->history[srv->history_head];
+        uint64_t lost = srv->missed - missed;
+    
+        missed = srv->missed;
+        srv->history_head = (srv->history_head + 1) % CLI_CONTROL_HISTORY;
+        if (srv->history_count < CLI_CONTROL_HISTORY)
+            srv->history_count++;
+    
+        memset(ev, 0, sizeof(*ev));
+        ev->seq = record.seq;
+        snprintf(ev->timestamp, sizeof(ev->timestamp), "%s", record.timestamp);
+        snprintf(ev->event_type, sizeof(ev->event_type), "%s", record.event_type);
+        snprintf(ev->interface, sizeof(ev->interface), "%s", record.interface);
+        snprintf(ev->message, sizeof(ev->message), "%s", record.message);
+    
+        if (!atomic_load_explicit(&srv->subscribers, memory_order_relaxed))
+            continue;
+    
+        for (int i = 0; i < CLI_CONTROL_MAX_CLIENTS; i++) {
+            struct control_client *client = &srv->clients[i];
+            struct cli_control_event out;
+    
+            if (client->fd < 0 || !client->subscribed)
+                continue;
+            client->missed += lost;
+            if (client->filtered && !(record.tags & (1ull << i)))
+                continue;
+    
+            out = *ev;
+            out.missed = client->missed;
+            if (send_packet(client->fd, CLI_CONTROL_EVENT, 0, 0, &out, sizeof(out), false)) {
+                client->missed = 0;
+            } else {
+                client->missed++;
+                srv->dropped++;
+            }
+        }
+    }
+}
+
+static void *control_thread(void *arg)
+{
+    struct cli_control_server *srv = arg;
+    struct pollfd pfds[1 + CLI_CONTROL_MAX_CLIENTS];
+    int slots[1 + CLI_CONTROL_MAX_CLIENTS];
+    
+    while (!atomic_load_explicit(&srv->stop, memory_order_acquire)) {
+        int n = 0;
+    
+        pfds[n].fd = srv->listen_fd;
+        pfds[n].events = POLLIN;
+        n++;
+        for (int i = 0; i < CLI_CONTROL_MAX_CLIENTS; i++) {
+            if (srv->clients[i].fd < 0)
+                continue;
+            pfds[n].fd = srv->clients[i].fd;
+            pfds[n].events = POLLIN;
+            slots[n++] = i;
+        }
+    
+        if (poll(pfds, n, POLL_MS) > 0) {
+            if (pfds[0].revents & POLLIN)
+                accept_client(srv);
+            for (int j = 1; j < n; j++) {
+                if (pfds[j].revents && !serve_client(srv, slots[j]))
+                    drop_client(srv, slots[j]);
+            }
+        }
+    
+        drain_feed(srv);
+    }
+    return NULL;
+}
+
+struct cli_control_server *cli_control_server_create(const char *path,
+                                                     const struct cli_control_context *ctx)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct cli_control_server *srv;
+    int fd;
+    
+    if (!path || !path[0] || strlen(path) >= sizeof(addr.sun_path))
+        return NULL;
+    strcpy(addr.sun_path, path);
+    
+    srv = calloc(1, sizeof(*srv));
+    if (!srv)
+        return NULL;
+    
+    if (ctx)
+        srv->ctx = *ctx;
+    snprintf(srv->path, sizeof(srv->path), "%s", path);
+    srv->listen_fd = -1;
+    for (int i = 0; i < CLI_CONTROL_MAX_CLIENTS; i++)
+        srv->clients[i].fd = -1;
+    pthread_mutex_init(&srv->filters_lock, NULL);
+    
+    srv->feed = cli_feed_create(FEED_CAPACITY);
+    srv->history = calloc(CLI_CONTROL_HISTORY, sizeof(*srv->history));
+    if (!srv->feed || !srv->history)
+        goto fail;
+    
+    /* A socket still answering belongs to a running server, leave it */
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        goto fail;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        close(fd);
+        errno = EADDRINUSE;
+        goto fail;
+    }
+    close(fd);
+    unlink(path);
+    
+    srv->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (srv->listen_fd < 0 ||
+        bind(srv->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        goto fail;
+    
+    /* Filters change what the daemon does, only its user may connect */
+    if (chmod(path, S_IRUSR | S_IWUSR) < 0 || listen(srv->listen_fd, 8) < 0)
+        goto fail_unlink;
+    
+    if (pthread_create(&srv->thread, NULL, control_thread, srv) != 0)
+        goto fail_unlink;
+    pthread_setname_np(srv->thread, "control");
+    
+    return srv;
+
+fail_unlink:
+    unlink(path);
+fail:
+    if (srv->listen_fd >= 0)
+        close(srv->listen_fd);
+    free(srv->history);
+    cli_feed_destroy(srv->feed);
+    pthread_mutex_destroy(&srv->filters_lock);
+    free(srv);
+    return NULL;
+}
+
+void cli_control_server_destroy(struct cli_control_server *srv)
+{
+    if (!srv)
+        return;
+    
+    atomic_store_explicit(&srv->stop, true, memory_order_release);
+    pthread_join(srv->thread, NULL);
+    
+    for (int i = 0; i < CLI_CONTROL_MAX_CLIENTS; i++) {
+        if (srv->clients[i].fd >= 0)
+            drop_client(srv, i);
+    }
+    close(srv->listen_fd);
+    unlink(srv->path);
+    
+    free(srv->history);
+    cli_feed_destroy(srv->feed);
+    pthread_mutex_destroy(&srv->filters_lock);
+    free(srv);
+}
@@ -0,0 +1,152 @@
+/* cli_control_client.c - Control protocol, client side
+ *
+ * Depends on nothing but libc, for tools that talk to a running nlmon.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "cli_control.h"
+
+int cli_control_connect(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    uint32_t version = CLI_CONTROL_VERSION;
+    struct cli_control_hdr hdr;
+    int fd, err;
+    ssize_t n;
+    
+    if (!path || strlen(path) >= sizeof(addr.sun_path)) {
+        errno = EINVAL;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        goto fail;
+    
+    if (cli_control_send(fd, CLI_CONTROL_HELLO, 0, &version, sizeof(version)) < 0)
+        goto fail;
+    n = cli_control_recv(fd, &hdr, &version, sizeof(version), 5000);
+    if (n < 0)
+        goto fail;
+    if (n == 0 && hdr.type == 0) {
+        errno = ETIMEDOUT;
+        goto fail;
+    }
+    if (hdr.type != CLI_CONTROL_HELLO || hdr.status != 0) {
+        errno = EPROTONOSUPPORT;
+        goto fail;
+    }
+    return fd;
+
+fail:
+    err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+}
+
+int cli_control_send(int fd, uint16_t type, uint32_t id, const void *payload, size_t len)
+{
+    struct cli_control_hdr hdr = {
+        .type = type,
+        .id = id,
+        .len = (uint32_t)len,
+    };
+    struct iovec iov[2] = {
+        { .iov_base = &hdr, .iov_len = sizeof(hdr) },
+        { .iov_base = (void *)payload, .iov_len = len },
+    };
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = len ? 2 : 1,
+    };
+    
+    if (sizeof(hdr) + len > CLI_CONTROL_MAX_PACKET) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    
+    while (sendmsg(fd, &msg, MSG_NOSIGNAL) < 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return 0;
+}
+
+ssize_t cli_control_recv(int fd, struct cli_control_hdr *hdr, void *payload, size_t max,
+                         int timeout_ms)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    struct iovec iov[2] = {
+        { .iov_base = hdr, .iov_len = sizeof(*hdr) },
+        { .iov_base = payload, .iov_len = max },
+    };
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = 2,
+    };
+    ssize_t n;
+    int ret;
+    
+    memset(hdr, 0, sizeof(*hdr));
+    
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0)
+        return -1;
+    if (ret == 0)
+        return 0;
+    
+    do {
+        n = recvmsg(fd, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return -1;
+    if (n == 0) {
+        errno = ECONNRESET;
+        return -1;
+    }
+    if ((size_t)n < sizeof(*hdr) || (msg.msg_flags & MSG_TRUNC) ||
+        hdr->len != (size_t)n - sizeof(*hdr)) {
+        errno = EPROTO;
+        return -1;
+    }
+    return (ssize_t)hdr->len;
+}
+
+int cli_control_call(int fd, uint16_t type, const void *req, size_t req_len,
+                     void *resp, size_t resp_max)
+{
+    static uint32_t next_id;
+    struct cli_control_hdr hdr;
+    char scratch[CLI_CONTROL_MAX_PACKET];
+    uint32_t id = ++next_id;
+    ssize_t n;
+    
+    if (cli_control_send(fd, type, id, req, req_len) < 0)
+        return -errno;
+    
+    for (;;) {
+        /* Events of a subscription may come first */
+        n = cli_control_recv(fd, &hdr, scratch, sizeof(scratch), -1);
+        if (n < 0)
+            return -errno;
+        if (hdr.type == CLI_CONTROL_EVENT && hdr.id == 0)
+            continue;
+        if (hdr.id != id)
+            continue;
+        if (resp && resp_max)
+            memcpy(resp, scratch, (size_t)n < resp_max ? (size_t)n : resp_max);
+        return hdr.status;
+    }
+}
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "cli_feed.h"
+
+/* Ring slot: seq is 2 * position + 1 while the producer writes the
+ * record and 2 * position + 2 once it is complete */
+struct feed_slot {
+    _Atomic uint64_t seq;
+    struct cli_feed_record record;
+};
+
+/* Counter snapshot, seq is odd while the producer updates it */
+struct feed_counters {
+    _Atomic uint64_t seq;
+    _Atomic uint64_t published;
+    _Atomic uint64_t link_events;
+    _Atomic uint64_t route_events;
+    _Atomic uint64_t addr_events;
+    _Atomic uint64_t neigh_events;
+    _Atomic uint64_t rule_events;
+};
+
+struct cli_feed {
+    struct feed_slot *slots;
+    size_t capacity;
+    size_t mask;
+
+    /* Producer side */
+    char pad_head[64];
+    _Atomic uint64_t head;          /* Records published */
+    struct cli_feed_stats counts;   /* Producer's own copy of the counters */
+    char pad_counters[64];
+
+    struct feed_counters snapshot;
+};
+
+/* Create a feed */
+struct cli_feed *cli_feed_create(size_t capacity)
+{
+    struct cli_feed *feed;
+    size_t size = 1;
+    
+    if (capacity == 0)
+        capacity = CLI_FEED_DEFAULT_CAPACITY;
+    while (size < capacity)
+        size <<= 1;
+    
+    feed = calloc(1, sizeof(*feed));
+    if (!feed)
+        return NULL;
+    
+    feed->slots = calloc(size, sizeof(*feed->slots));
+    if (!feed->slots) {
+        free(feed);
+        return NULL;
+    }
+    
+    feed->capacity = size;
+    feed->mask = size - 1;
+    return feed;
+}
+
+/* Destroy a feed */
+void cli_feed_destroy(struct cli_feed *feed)
+{
+    if (!feed)
+        return;
+    
+    free(feed->slots);
+    free(feed);
+}
+
+/* Count an event the way the CLI statistics panel groups them */
+static void count_event_type(struct cli_feed_stats *counts, const char *event_type)
+{
+    counts->published++;
+    
+    if (!event_type)
+        return;
+    
+    if (strstr(event_type, "link") || strstr(event_type, "LINK"))
+        counts->link_events++;
+    else if (strstr(event_type, "route") || strstr(event_type, "ROUTE"))
+        counts->route_events++;
+    else if (strstr(event_type, "addr") || strstr(event_type, "ADDR"))
+        counts->addr_events++;
+    else if (strstr(event_type, "neigh") || strstr(event_type, "NEIGH"))
+        counts->neigh_events++;
+    else if (strstr(event_type, "rule") || strstr(event_type, "RULE"))
+        counts->rule_events++;
+}
+
+/* Publish the producer's counters to the snapshot */
+static void publish_counters(struct cli_feed *feed)
+{
+    struct feed_counters *snap = &feed->snapshot;
+    uint64_t seq = atomic_load_explicit(&snap->seq, memory_order_relaxed);
+    
+    atomic_store_explicit(&snap->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    
+    atomic_store_explicit(&snap->published, feed->counts.published, memory_order_relaxed);
+    atomic_store_explicit(&snap->link_events, feed->counts.link_events, memory_order_relaxed);
+    atomic_store_explicit(&snap->route_events, feed->counts.route_events, memory_order_relaxed);
+    atomic_store_explicit(&snap->addr_events, feed->counts.addr_events, memory_order_relaxed);
+    atomic_store_explicit(&snap->neigh_events, feed->counts.neigh_events, memory_order_relaxed);
+    atomic_store_explicit(&snap->rule_events, feed->counts.rule_events, memory_order_relaxed);
+    
+    atomic_store_explicit(&snap->seq, seq + 2, memory_order_release);
+}
+
+/* Publish an event */
+void cli_feed_publish(struct cli_feed *feed, const char *timestamp,
+                      const char *event_type, const char *interface,
+                      const char *message, const char *details_json)
+{
+    cli_feed_publish_tagged(feed, 0, timestamp, event_type, interface, message, details_json);
+}
+
+/* Publish an event with tags */
+void cli_feed_publish_tagged(struct cli_feed *feed, uint64_t tags, const char *timestamp,
+                             const char *event_type, const char *interface,
+                             const char *message, const char *details_json)
+{
+    struct feed_slot *slot;
+    struct cli_feed_record *record;
+    uint64_t pos;
+    
+    if (!feed)
+        return;
+    
+    pos = atomic_load_explicit(&feed->head, memory_order_relaxed);
+    slot = &feed->slots[pos & feed->mask];
+    record = &slot->record;
+    
+    /* Readers of the slot's previous record see it change under them */
+    atomic_store_explicit(&slot->seq, 2 * pos + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    
+    record->seq = pos + 1;
+    record->tags = tags;
+    snprintf(record->timestamp, sizeof(record->timestamp), "%s", timestamp ? timestamp : "");
+    snprintf(record->event_type, sizeof(record->event_type), "%s", event_type ? event_type : "");
+    snprintf(record->interface, sizeof(record->interface), "%s", interface ? interface : "");
+    snprintf(record->message, sizeof(record->message), "%s", message ? message : "");
+    snprintf(record->details_json, sizeof(record->details_json), "%s",
+             details_json ? details_json : "{}");
+    
+    atomic_store_explicit(&slot->seq, 2 * pos + 2, memory_order_release);
+    atomic_store_explicit(&feed->head, pos + 1, memory_order_release);
+    
+    count_event_type(&feed->counts, event_type);
+    publish_counters(feed);
+}
+
+/* Read the next record */
+bool cli_feed_next(struct cli_feed *feed, uint64_t *cursor,
+                   struct cli_feed_record *record, uint64_t *missed)
+{
+    if (!feed || !cursor || !record)
+        return false;
+    
+    for (;;) {
+        uint64_t head = atomic_load_explicit(&feed->head, memory_order_acquire);
+        uint64_t pos = *cursor;
+        struct feed_slot *slot;
+        uint64_t before, after;
+    
+        if (pos >= head)
+            return false;
+    
+        /* Everything older than one ring behind the head is gone */
+        if (head - pos > feed->capacity) {
+            if (missed)
+                *missed += head - feed->capacity - pos;
+            pos = head - feed->capacity;
+        }
+    
+        slot = &feed->slots[pos & feed->mask];
+        before = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (before == 2 * pos + 2) {
+            memcpy(record, &slot->record, sizeof(*record));
+            atomic_thread_fence(memory_order_acquire);
+            after = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+            if (after == before) {
+                *cursor = pos + 1;
+                return true;
+            }
+        }
+    
+        /* The producer lapped us on this slot */
+        if (missed)
+            (*missed)++;
+        *cursor = pos + 1;
+    }
+}
+
+/* Get a snapshot of the counters */
+void cli_feed_get_stats(struct cli_feed *feed, struct cli_feed_stats *stats)
+{
+    struct feed_counters *snap;
+    uint64_t before, after;
+    
+    if (!stats)
+        return;
+    
+    memset(stats, 0, sizeof(*stats));
+    if (!feed)
+        return;
+    
+    snap = &feed->snapshot;
+    do {
+        before = atomic_load_explicit(&snap->seq, memory_order_acquire);
+        if (before & 1)
+            continue;
+    
+        stats->published = atomic_load_explicit(&snap->published, memory_order_relaxed);
+        stats->link_events = atomic_load_explicit(&snap->link_events, memory_order_relaxed);
+        stats->route_events = atomic_load_explicit(&snap->route_events, memory_order_relaxed);
+        stats->addr_events = atomic_load_explicit(&snap->addr_events, memory_order_relaxed);
+        stats->neigh_events = atomic_load_explicit(&snap->neigh_events, memory_order_relaxed);
+        stats->rule_events = atomic_load_explicit(&snap->rule_events, memory_order_relaxed);
+    
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&snap->seq, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+}
@@ -1,13 +1,19 @@
 #include <stdio.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <pthread.h>
 #include "cli_interface.h"
+#include "cli_integration.h"
+#include "cli_feed.h"
+#include "cli_control.h"
+#include "plugin_manager.h"
 
 /* Global CLI state */
 static cli_state_t *g_cli_state = NULL;
+static struct cli_feed *g_cli_feed = NULL;
 static pthread_t g_cli_thread;
 static bool g_cli_running = false;
 
@@ -17,21 +23,27 @@ static void *cli_update_thread(void *arg)
     cli_state_t *state = (cli_state_t *)arg;
     
     while (state && state->running) {
-        /* Handle input */
-        int ch = getch();
-        if (ch != ERR) {
+        struct timespec start, end;
+        long elapsed_us;
+        int ch;
+        
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        
+        /* Handle all input queued since the last frame */
+        while (state->running && (ch = getch()) != ERR) {
             cli_handle_input(state, ch);
         }
         
-        /* Refresh display if needed */
-        for (int i = 0; i < PANEL_MAX; i++) {
-            if (state->panels[i].needs_refresh) {
-                cli_refresh_panel(state, i);
-            }
-        }
+        /* Draw whatever changed, however many events arrived */
+        cli_render_frame(state);
         
-        /* Sleep briefly to avoid busy-waiting */
-        usleep(50000); /* 50ms */
+        /* Sleep out the rest of the frame */
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        elapsed_us = (end.tv_sec - start.tv_sec) * 1000000L +
+                     (end.tv_nsec - start.tv_nsec) / 1000;
+        if (elapsed_us < state->frame_interval_ms * 1000L) {
+            usleep(state->frame_interval_ms * 1000L - elapsed_us);
+        }
     }
     
     return NULL;
@@ -44,15 +56,25 @@ int cli_enhanced_init(void)
         return 0; /* Already initialized */
     }
     
+    g_cli_feed = cli_feed_create(0);
+    if (!g_cli_feed) {
+        return -1;
+    }
+    
     if (cli_init(&g_cli_state) < 0) {
+        cli_feed_destroy(g_cli_feed);
+        g_cli_feed = NULL;
         return -1;
     }
+    cli_attach_feed(g_cli_state, g_cli_feed);
     
     /* Start CLI update thread */
     g_cli_running = true;
     if (pthread_create(&g_cli_thread, NULL, cli_update_thread, g_cli_state) != 0) {
         cli_cleanup(g_cli_state);
         g_cli_state = NULL;
+        cli_feed_destroy(g_cli_feed);
+        g_cli_feed = NULL;
         return -1;
     }
     
@@ -77,27 +99,132 @@ void cli_enhanced_cleanup(void)
     
     cli_cleanup(g_cli_state);
     g_cli_state = NULL;
+    cli_feed_destroy(g_cli_feed);
+    g_cli_feed = NULL;
 }
 
 /* Log event to enhanced CLI */
 void cli_enhanced_log_event(const char *event_type, const char *interface, 
                             const char *message, const char *details_json)
 {
-    if (!g_cli_state) {
+    if (!g_cli_feed) {
         return;
     }
     
     /* Generate timestamp */
     time_t now;
-    struct tm *tm_info;
+    struct tm tm_buf, *tm_info;
     char timestamp[32];
     
     time(&now);
-    tm_info = localtime(&now);
+    tm_info = localtime_r(&now, &tm_buf);
     strftime(timestamp, sizeof(timestamp), "%H:%M:%S", tm_info);
     
-    /* Add event to CLI */
-    cli_add_event(g_cli_state, timestamp, event_type, interface, message, details_json);
+    /* Hand the event to the UI thread without waiting for it */
+    cli_feed_publish(g_cli_feed, timestamp, event_type, interface, message, details_json);
+}
+
+/* Live events held back while the backlog of an attach is read */
+#define CLI_ATTACH_STASH 256
+
+/* Show an event of a control connection */
+static void cli_attach_show(struct cli_control_event *ev)
+{
+    ev->timestamp[sizeof(ev->timestamp) - 1] = '\0';
+    ev->event_type[sizeof(ev->event_type) - 1] = '\0';
+    ev->interface[sizeof(ev->interface) - 1] = '\0';
+    ev->message[sizeof(ev->message) - 1] = '\0';
+    cli_feed_publish(g_cli_feed, ev->timestamp, ev->event_type, ev->interface,
+                     ev->message, NULL);
+}
+
+/* Run the CLI on the events of a running daemon */
+int cli_enhanced_attach(const char *path)
+{
+    struct cli_control_event ev, *stash;
+    struct cli_control_query query;
+    struct cli_control_filter all;
+    struct cli_control_hdr hdr;
+    size_t stashed = 0;
+    uint64_t last_seq = 0;
+    bool backfilled = false;
+    int fd, ret = 0;
+    
+    fd = cli_control_connect(path);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    stash = calloc(CLI_ATTACH_STASH, sizeof(*stash));
+    if (!stash || cli_enhanced_init() < 0) {
+        free(stash);
+        close(fd);
+        return -1;
+    }
+    
+    /* Subscribe before reading the backlog so nothing falls in between;
+     * live events are held until the backlog is shown, then the ones it
+     * already had are skipped. */
+    memset(&all, 0, sizeof(all));
+    memset(&query, 0, sizeof(query));
+    if (cli_control_send(fd, CLI_CONTROL_SUBSCRIBE, 1, &all, sizeof(all)) < 0 ||
+        cli_control_send(fd, CLI_CONTROL_QUERY, 2, &query, sizeof(query)) < 0) {
+        ret = -1;
+    }
+    
+    while (ret == 0 && cli_enhanced_is_running()) {
+        ssize_t n = cli_control_recv(fd, &hdr, &ev, sizeof(ev), 100);
+        
+        if (n < 0) {
+            ret = errno == ECONNRESET ? 0 : -1;
+            break;
+        }
+        if (hdr.status != 0) {
+            ret = -1;
+            break;
+        }
+        if (hdr.type == CLI_CONTROL_END) {
+            backfilled = true;
+            for (size_t i = 0; i < stashed; i++) {
+                if (stash[i].seq > last_seq) {
+                    cli_attach_show(&stash[i]);
+                }
+            }
+            stashed = 0;
+            continue;
+        }
+        if (hdr.type != CLI_CONTROL_EVENT || (size_t)n != sizeof(ev)) {
+            continue;
+        }
+        
+        if (hdr.id != 0) {
+            last_seq = ev.seq;
+            cli_attach_show(&ev);
+        } else if (backfilled) {
+            cli_attach_show(&ev);
+        } else if (stashed < CLI_ATTACH_STASH) {
+            stash[stashed++] = ev;
+        }
+    }
+    
+    cli_enhanced_cleanup();
+    free(stash);
+    close(fd);
+    return ret;
+}
+
+/* Plugin statistics for the CLI dialog */
+static size_t cli_plugin_report(void *ctx, char *buf, size_t len)
+{
+    return plugin_manager_format_stats(ctx, buf, len);
+}
+
+/* Show plugin statistics from a plugin manager */
+void cli_enhanced_set_plugin_manager(plugin_manager_t *mgr)
+{
+    if (g_cli_state) {
+        cli_set_plugin_report(g_cli_state, mgr ? cli_plugin_report : NULL, mgr);
+    }
 }
 
 /* Check if CLI is running */
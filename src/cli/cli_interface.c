@@ -5,6 +5,7 @@
 #include <regex.h>
 #include <time.h>
 #include "cli_interface.h"
+#include "cli_feed.h"
 
 /* Color pairs */
 #define COLOR_PAIR_NORMAL     1
@@ -18,6 +19,28 @@
 #define COLOR_PAIR_ERROR      9
 #define COLOR_PAIR_SUCCESS    10
 
+/* Events panel row keys; event rows use (seq << 2) | flags */
+#define ROW_KEY_UNKNOWN       0
+#define ROW_KEY_BLANK         1
+
+/* Get monotonic time in milliseconds */
+static long long cli_now_ms(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Forget what the events panel rows show, forcing a full repaint */
+static void cli_invalidate_rows(cli_state_t *state)
+{
+    if (state->row_keys && state->row_key_count > 0)
+        memset(state->row_keys, 0, sizeof(*state->row_keys) * state->row_key_count);
+}
+
+static void cli_drain_feed(cli_state_t *state);
+
 /* Initialize CLI state */
 int cli_init(cli_state_t **state)
 {
@@ -54,6 +77,9 @@ int cli_init(cli_state_t **state)
     s->show_timestamps = true;
     s->running = true;
     s->focused_panel = PANEL_EVENTS;
+    s->frame_interval_ms = CLI_FRAME_INTERVAL_MS;
+    s->rate_window_start = cli_now_ms();
+    s->next_seq = 1;
     
     /* Create panels */
     if (cli_create_panels(s) < 0) {
@@ -81,6 +107,7 @@ void cli_cleanup(cli_state_t *state)
         event = next;
     }
     
+    free(state->row_keys);
     pthread_mutex_destroy(&state->lock);
     endwin();
     free(state);
@@ -206,6 +233,9 @@ void cli_destroy_panels(cli_state_t *state)
             state->panels[i].win = NULL;
         }
     }
+    
+    /* New windows start out blank */
+    cli_invalidate_rows(state);
 }
 
 /* Resize panels */
@@ -236,15 +266,9 @@ void cli_set_focus(cli_state_t *state, panel_type_t panel)
     cli_refresh_all(state);
 }
 
-/* Refresh a single panel */
-void cli_refresh_panel(cli_state_t *state, panel_type_t panel)
+/* Draw a panel into its window; shown by the next doupdate() */
+static void cli_draw_panel(cli_state_t *state, panel_type_t panel)
 {
-    if (!state || panel >= PANEL_MAX)
-        return;
-    
-    if (!state->panels[panel].visible || !state->panels[panel].win)
-        return;
-    
     switch (panel) {
     case PANEL_EVENTS:
         cli_draw_events_panel(state);
@@ -261,11 +285,18 @@ void cli_refresh_panel(cli_state_t *state, panel_type_t panel)
     default:
         break;
     }
+}
+
+/* Mark a panel for redrawing on the next frame */
+void cli_refresh_panel(cli_state_t *state, panel_type_t panel)
+{
+    if (!state || panel >= PANEL_MAX)
+        return;
     
-    state->panels[panel].needs_refresh = false;
+    state->panels[panel].needs_refresh = true;
 }
 
-/* Refresh all panels */
+/* Mark the whole screen for redrawing on the next frame */
 void cli_refresh_all(cli_state_t *state)
 {
     if (!state)
@@ -273,31 +304,95 @@ void cli_refresh_all(cli_state_t *state)
     
     pthread_mutex_lock(&state->lock);
     
-    for (int i = 0; i < PANEL_MAX; i++) {
-        if (state->panels[i].visible)
-            cli_refresh_panel(state, i);
-    }
+    state->full_redraw = true;
+    for (int i = 0; i < PANEL_MAX; i++)
+        state->panels[i].needs_refresh = true;
     
     pthread_mutex_unlock(&state->lock);
 }
 
-/* Add event to list */
-int cli_add_event(cli_state_t *state, const char *timestamp, const char *event_type,
-                  const char *interface, const char *message, const char *details_json)
+/* Render one frame
+ *
+ * Called at a fixed rate by the UI thread, however fast events arrive.
+ * Events added since the last frame have only been counted and linked
+ * in, and the attached feed is drained here; they all show up together
+ * in this frame. Only panels marked for refresh
+ * are drawn, and all of them reach the terminal in a single update.
+ */
+void cli_render_frame(cli_state_t *state)
 {
-    cli_event_entry_t *event;
+    bool drawn = false;
+    long long now;
     
     if (!state)
-        return -1;
+        return;
     
     pthread_mutex_lock(&state->lock);
     
+    if (state->feed)
+        cli_drain_feed(state);
+    
+    /* Fold the events counted since the last second into a rate */
+    now = cli_now_ms();
+    if (now - state->rate_window_start >= 1000) {
+        unsigned long rate = (unsigned long)(state->window_events * 1000 /
+                                             (now - state->rate_window_start));
+        
+        if (rate != state->event_rate) {
+            state->event_rate = rate;
+            state->panels[PANEL_STATS].needs_refresh = true;
+        }
+        state->window_events = 0;
+        state->rate_window_start = now;
+    }
+    
+    /* After a dialog closed the windows still hold their contents, the
+     * terminal just has to be told to show them again */
+    if (state->full_redraw) {
+        for (int i = 0; i < PANEL_MAX; i++) {
+            if (state->panels[i].win)
+                touchwin(state->panels[i].win);
+        }
+        state->full_redraw = false;
+        drawn = true;
+    }
+    
+    for (int i = 0; i < PANEL_MAX; i++) {
+        cli_panel_t *panel = &state->panels[i];
+        
+        if (!panel->needs_refresh)
+            continue;
+        panel->needs_refresh = false;
+        
+        if (!panel->visible || !panel->win)
+            continue;
+        cli_draw_panel(state, i);
+        drawn = true;
+    }
+    
+    if (drawn)
+        state->frames_rendered++;
+    
+    pthread_mutex_unlock(&state->lock);
+    
+    if (drawn)
+        doupdate();
+}
+
+/* Link a new event in, with the state lock held */
+static int cli_append_event(cli_state_t *state, const char *timestamp, const char *event_type,
+                            const char *interface, const char *message, const char *details_json)
+{
+    cli_event_entry_t *event;
+    
     /* Check capacity */
     if (state->event_count >= state->event_capacity) {
         /* Remove oldest event */
         cli_event_entry_t *oldest = state->events;
         if (oldest) {
             state->events = oldest->next;
+            if (!state->events)
+                state->events_tail = NULL;
             free(oldest);
             state->event_count--;
         }
@@ -305,10 +400,8 @@ int cli_add_event(cli_state_t *state, const char *timestamp, const char *event_t
     
     /* Create new event */
     event = calloc(1, sizeof(cli_event_entry_t));
-    if (!event) {
-        pthread_mutex_unlock(&state->lock);
+    if (!event)
         return -1;
-    }
     
     /* Copy data */
     snprintf(event->timestamp, sizeof(event->timestamp), "%s", timestamp ? timestamp : "");
@@ -318,29 +411,98 @@ int cli_add_event(cli_state_t *state, const char *timestamp, const char *event_t
     snprintf(event->details_json, sizeof(event->details_json), "%s", details_json ? details_json : "{}");
     
     event->color_pair = cli_get_event_color(event_type);
+    event->seq = state->next_seq++;
     
     /* Add to end of list */
-    if (!state->events) {
+    if (!state->events)
         state->events = event;
-    } else {
-        cli_event_entry_t *last = state->events;
-        while (last->next)
-            last = last->next;
-        last->next = event;
-    }
+    else
+        state->events_tail->next = event;
+    state->events_tail = event;
     
     state->event_count++;
-    
-    /* Update statistics */
-    cli_update_stats(state, event_type);
+    state->window_events++;
     
     /* Mark panels for refresh */
     state->panels[PANEL_EVENTS].needs_refresh = true;
     state->panels[PANEL_STATS].needs_refresh = true;
     
+    return 0;
+}
+
+/* Add event to list */
+int cli_add_event(cli_state_t *state, const char *timestamp, const char *event_type,
+                  const char *interface, const char *message, const char *details_json)
+{
+    int ret;
+    
+    if (!state)
+        return -1;
+    
+    pthread_mutex_lock(&state->lock);
+    
+    ret = cli_append_event(state, timestamp, event_type, interface, message, details_json);
+    
+    /* Update statistics */
+    if (ret == 0 && !state->feed)
+        cli_update_stats(state, event_type);
+    
     pthread_mutex_unlock(&state->lock);
     
-    return 0;
+    return ret;
+}
+
+/* Take events from a snapshot feed
+ *
+ * The feed is drained by the UI thread at the start of every frame, so
+ * its producer never touches the state lock and the statistics come from
+ * the feed's own counters, including events the UI was too slow to show.
+ */
+void cli_attach_feed(cli_state_t *state, struct cli_feed *feed)
+{
+    if (!state)
+        return;
+    
+    pthread_mutex_lock(&state->lock);
+    state->feed = feed;
+    state->feed_cursor = 0;
+    state->feed_missed = 0;
+    pthread_mutex_unlock(&state->lock);
+}
+
+/* Move the records published since the last frame into the event list */
+static void cli_drain_feed(cli_state_t *state)
+{
+    struct cli_feed_record record;
+    struct cli_feed_stats stats;
+    uint64_t missed = 0;
+    int budget = state->event_capacity;
+    
+    /* A record beyond the event capacity would push out another one of
+     * this frame, so a burst stops here and continues next frame */
+    while (budget-- > 0 && cli_feed_next(state->feed, &state->feed_cursor, &record, &missed)) {
+        cli_append_event(state, record.timestamp, record.event_type, record.interface,
+                         record.message, record.details_json);
+    }
+    
+    if (missed) {
+        state->feed_missed += missed;
+        state->window_events += missed;
+    }
+    
+    cli_feed_get_stats(state->feed, &stats);
+    if (stats.link_events != state->link_events ||
+        stats.route_events != state->route_events ||
+        stats.addr_events != state->addr_events ||
+        stats.neigh_events != state->neigh_events ||
+        stats.rule_events != state->rule_events || missed) {
+        state->link_events = stats.link_events;
+        state->route_events = stats.route_events;
+        state->addr_events = stats.addr_events;
+        state->neigh_events = stats.neigh_events;
+        state->rule_events = stats.rule_events;
+        state->panels[PANEL_STATS].needs_refresh = true;
+    }
 }
 
 /* Clear all events */
@@ -359,6 +521,7 @@ void cli_clear_events(cli_state_t *state)
     }
     
     state->events = NULL;
+    state->events_tail = NULL;
     state->event_count = 0;
     state->event_scroll = 0;
     state->selected_event = 0;
@@ -403,7 +566,13 @@ void cli_update_stats(cli_state_t *state, const char *event_type)
         state->rule_events++;
 }
 
-/* Draw events panel */
+/* Draw events panel
+ *
+ * The list is virtualized: only the rows in view are looked at, and a
+ * row is formatted and written only when the event it shows, its
+ * selection or the column layout changed since the last frame. A burst
+ * of events therefore costs one repaint of the rows it scrolled.
+ */
 void cli_draw_events_panel(cli_state_t *state)
 {
     WINDOW *win;
@@ -419,7 +588,21 @@ void cli_draw_events_panel(cli_state_t *state)
     win = state->panels[PANEL_EVENTS].win;
     getmaxyx(win, height, width);
     
-    werase(win);
+    display_lines = height - 2;
+    if (display_lines < 0)
+        display_lines = 0;
+    
+    if (state->row_key_count != display_lines) {
+        unsigned long *keys = realloc(state->row_keys,
+                                      sizeof(*keys) * (display_lines ? display_lines : 1));
+        if (!keys)
+            return;
+        state->row_keys = keys;
+        state->row_key_count = display_lines;
+        cli_invalidate_rows(state);
+    }
+    
+    /* The border also carries the status badges and scroll position */
     box(win, 0, 0);
     
     /* Draw title with focus indicator */
@@ -450,8 +633,6 @@ void cli_draw_events_panel(cli_state_t *state)
         wattroff(win, COLOR_PAIR(COLOR_PAIR_ERROR));
     }
     
-    display_lines = height - 2;
-    
     /* Calculate starting index for scrolling */
     start_idx = state->event_count - display_lines - state->event_scroll;
     if (start_idx < 0)
@@ -465,38 +646,51 @@ void cli_draw_events_panel(cli_state_t *state)
         index++;
     }
     
-    /* Draw events */
-    line = 1;
-    while (event && line < height - 1) {
-        bool is_selected = (index == state->selected_event);
+    /* Draw the rows that changed */
+    for (line = 0; line < display_lines; line++) {
+        unsigned long key = ROW_KEY_BLANK;
+        bool is_selected = false;
         
-        if (is_selected) {
-            wattron(win, COLOR_PAIR(COLOR_PAIR_SELECTED));
-        } else if (state->colors_enabled) {
-            wattron(win, COLOR_PAIR(event->color_pair));
+        if (event) {
+            is_selected = (index == state->selected_event);
+            key = (event->seq << 2) | (is_selected ? 2 : 0) |
+                  (state->show_timestamps ? 1 : 0);
         }
         
-        /* Format event line */
-        char line_buf[512];
-        if (state->show_timestamps) {
-            snprintf(line_buf, sizeof(line_buf), "%-10s %-12s %-15s %s",
-                    event->timestamp, event->event_type, event->interface, event->message);
-        } else {
-            snprintf(line_buf, sizeof(line_buf), "%-12s %-15s %s",
-                    event->event_type, event->interface, event->message);
+        if (state->row_keys[line] != key) {
+            state->row_keys[line] = key;
+            
+            if (!event) {
+                mvwprintw(win, line + 1, 2, "%*s", width - 4, "");
+            } else {
+                char line_buf[512];
+                int attr = 0;
+                
+                if (is_selected)
+                    attr = COLOR_PAIR(COLOR_PAIR_SELECTED);
+                else if (state->colors_enabled)
+                    attr = COLOR_PAIR(event->color_pair);
+                
+                /* Format event line */
+                if (state->show_timestamps) {
+                    snprintf(line_buf, sizeof(line_buf), "%-10s %-12s %-15s %s",
+                            event->timestamp, event->event_type, event->interface, event->message);
+                } else {
+                    snprintf(line_buf, sizeof(line_buf), "%-12s %-15s %s",
+                            event->event_type, event->interface, event->message);
+                }
+                
+                /* Pad to the full width so no clear is needed */
+                wattron(win, attr);
+                mvwprintw(win, line + 1, 2, "%-*.*s", width - 4, width - 4, line_buf);
+                wattroff(win, attr);
+            }
         }
         
-        mvwprintw(win, line, 2, "%.*s", width - 4, line_buf);
-        
-        if (is_selected) {
-            wattroff(win, COLOR_PAIR(COLOR_PAIR_SELECTED));
-        } else if (state->colors_enabled) {
-            wattroff(win, COLOR_PAIR(event->color_pair));
+        if (event) {
+            event = event->next;
+            index++;
         }
-        
-        event = event->next;
-        index++;
-        line++;
     }
     
     /* Show scroll indicator */
@@ -505,7 +699,7 @@ void cli_draw_events_panel(cli_state_t *state)
                  state->event_count - state->event_scroll, state->event_count);
     }
     
-    wrefresh(win);
+    wnoutrefresh(win);
 }
 
 /* Draw details panel */
@@ -535,7 +729,7 @@ void cli_draw_details_panel(cli_state_t *state)
     event = cli_get_selected_event(state);
     if (!event) {
         mvwprintw(win, height / 2, (width - 20) / 2, "No event selected");
-        wrefresh(win);
+        wnoutrefresh(win);
         return;
     }
     
@@ -592,7 +786,7 @@ void cli_draw_details_panel(cli_state_t *state)
         }
     }
     
-    wrefresh(win);
+    wnoutrefresh(win);
 }
 
 /* Draw stats panel */
@@ -648,7 +842,11 @@ void cli_draw_stats_panel(cli_state_t *state)
     wprintw(win, "%-8lu", total);
     wattroff(win, A_BOLD);
     
-    wrefresh(win);
+    wprintw(win, " Rate: %lu/s", state->event_rate);
+    if (state->feed_missed)
+        wprintw(win, " Missed: %lu", state->feed_missed);
+    
+    wnoutrefresh(win);
 }
 
 /* Draw command panel */
@@ -680,7 +878,7 @@ void cli_draw_command_panel(cli_state_t *state)
         mvwprintw(win, 1, 2, "q:Quit h:Help c:Clear /:Search f:Filter s:Sort e:Export d:Details p:Pause");
     }
     
-    wrefresh(win);
+    wnoutrefresh(win);
 }
 
 /* Handle resize */
@@ -786,6 +984,11 @@ void cli_handle_input(cli_state_t *state, int ch)
         cli_show_export_dialog(state);
         break;
         
+    case 'i':
+    case 'I':
+        cli_show_plugin_dialog(state);
+        break;
+        
     case 'd':
     case 'D':
     case '\n':
@@ -1065,6 +1268,7 @@ void cli_show_general_help(WINDOW *help_win, int *line_ptr)
     mvwprintw(help_win, line++, 6, "f           - Open filter dialog");
     mvwprintw(help_win, line++, 6, "s           - Cycle sort order");
     mvwprintw(help_win, line++, 6, "e           - Export events");
+    mvwprintw(help_win, line++, 6, "i           - Plugin statistics");
     
     *line_ptr = line;
 }
@@ -1338,6 +1542,77 @@ void cli_show_export_dialog(cli_state_t *state)
     cli_refresh_all(state);
 }
 
+/* Set where the plugin statistics dialog gets its table from */
+void cli_set_plugin_report(cli_state_t *state,
+                           size_t (*report)(void *ctx, char *buf, size_t len), void *ctx)
+{
+    if (!state)
+        return;
+    
+    state->plugin_report = report;
+    state->plugin_report_ctx = ctx;
+}
+
+/* Show plugin statistics dialog */
+void cli_show_plugin_dialog(cli_state_t *state)
+{
+    WINDOW *dialog;
+    int max_y, max_x;
+    char report[8192];
+    
+    if (!state)
+        return;
+    
+    report[0] = '\0';
+    if (state->plugin_report)
+        state->plugin_report(state->plugin_report_ctx, report, sizeof(report));
+    
+    getmaxyx(stdscr, max_y, max_x);
+    dialog = newwin(max_y - 4, max_x - 4, 2, 2);
+    
+    if (!dialog)
+        return;
+    
+    box(dialog, 0, 0);
+    wattron(dialog, A_BOLD);
+    mvwprintw(dialog, 0, 2, " Plugins ");
+    wattroff(dialog, A_BOLD);
+    
+    if (!report[0]) {
+        mvwprintw(dialog, 2, 2, "No plugins loaded");
+    } else {
+        /* First row is the table header */
+        int line = 2;
+        char *row = report;
+        
+        while (*row && line < max_y - 7) {
+            char *end = strchr(row, '\n');
+            int row_len = end ? (int)(end - row) : (int)strlen(row);
+            
+            if (row_len > max_x - 8)
+                row_len = max_x - 8;
+            if (line == 2)
+                wattron(dialog, A_BOLD);
+            mvwprintw(dialog, line, 2, "%.*s", row_len, row);
+            if (line == 2)
+                wattroff(dialog, A_BOLD);
+            line++;
+            
+            if (!end)
+                break;
+            row = end + 1;
+        }
+    }
+    mvwprintw(dialog, max_y - 6, 2, "Press any key to close...");
+    
+    wrefresh(dialog);
+    nodelay(stdscr, FALSE);
+    getch();
+    nodelay(stdscr, TRUE);
+    delwin(dialog);
+    cli_refresh_all(state);
+}
+
 /* Sort events - placeholder */
 void cli_sort_events(cli_state_t *state)
 {
@@ -19,19 +19,27 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/inotify.h>
+#include <sys/socket.h>
 #include "nlmon_config.h"
+#include "nlmon_clock.h"
+#include "huge_alloc.h"
+#include "thread_affinity.h"
 
 /* Default configuration values */
 #define DEFAULT_BUFFER_SIZE (320 * 1024)
 #define DEFAULT_MAX_EVENTS 10000
 #define DEFAULT_RATE_LIMIT 1000
 #define DEFAULT_WORKER_THREADS 4
+#define DEFAULT_RATE_LIMIT_KEYS 1024
 #define DEFAULT_CLI_REFRESH_MS 100
 #define DEFAULT_CLI_MAX_HISTORY 1000
 #define DEFAULT_WEB_PORT 8080
 #define DEFAULT_METRICS_PORT 9090
 #define DEFAULT_PCAP_ROTATE_SIZE (100 * 1024 * 1024)
 #define DEFAULT_DB_RETENTION_DAYS 30
+#define DEFAULT_RING_BLOCK_SIZE (1024 * 1024)
+#define DEFAULT_RING_BLOCK_COUNT 16
+#define DEFAULT_RING_BLOCK_TIMEOUT_MS 64
 
 /* Initialize configuration with default values */
 int nlmon_config_init(struct nlmon_config *config)
@@ -49,6 +57,7 @@ int nlmon_config_init(struct nlmon_config *config)
 	config->core.max_events = DEFAULT_MAX_EVENTS;
 	config->core.rate_limit = DEFAULT_RATE_LIMIT;
 	config->core.worker_threads = DEFAULT_WORKER_THREADS;
+	config->core.rate_limit_keys = DEFAULT_RATE_LIMIT_KEYS;
 	
 	/* Monitoring defaults */
 	config->monitoring.protocol_count = 1;
@@ -64,6 +73,8 @@ int nlmon_config_init(struct nlmon_config *config)
 	
 	config->netlink.buffer_size.receive = 32768;
 	config->netlink.buffer_size.send = 32768;
+	config->netlink.buffer_size.autotune = true;
+	config->netlink.buffer_size.receive_max = 8 * 1024 * 1024;
 	
 	config->netlink.caching.enabled = false;
 	config->netlink.caching.link_cache = false;
@@ -73,6 +84,26 @@ int nlmon_config_init(struct nlmon_config *config)
 	config->netlink.multicast_groups.group_count = 0;
 	config->netlink.generic_families.family_count = 0;
 	
+	config->netlink.conntrack.events_new = true;
+	config->netlink.conntrack.events_update = true;
+	config->netlink.conntrack.events_destroy = true;
+	config->netlink.conntrack.l3proto = 0;
+	config->netlink.conntrack.l4proto = 0;
+	config->netlink.conntrack.zone = -1;
+	config->netlink.conntrack.mark = 0;
+	config->netlink.conntrack.mark_mask = 0;
+	
+	config->netlink.dispatch.budget = 64;
+	config->netlink.dispatch.route_weight = 1;
+	config->netlink.dispatch.generic_weight = 1;
+	config->netlink.dispatch.sock_diag_weight = 1;
+	
+	/* Capture defaults */
+	config->capture.mmap_ring = false;
+	config->capture.ring_block_size = DEFAULT_RING_BLOCK_SIZE;
+	config->capture.ring_block_count = DEFAULT_RING_BLOCK_COUNT;
+	config->capture.ring_block_timeout_ms = DEFAULT_RING_BLOCK_TIMEOUT_MS;
+	
 	/* Output defaults */
 	config->output.console.enabled = true;
 	strncpy(config->output.console.format, "text", sizeof(config->output.console.format) - 1);
@@ -124,6 +155,11 @@ void nlmon_config_free(struct nlmon_config *config)
 	if (!config)
 		return;
 	
+	if (config->prepared_free)
+		config->prepared_free(config->prepared);
+	config->prepared = NULL;
+	config->prepared_free = NULL;
+	
 	pthread_rwlock_destroy(&config->lock);
 }
 
@@ -146,12 +182,39 @@ int nlmon_config_validate(const struct nlmon_config *config)
 		return NLMON_CONFIG_ERR_VALIDATION;
 	}
 	
+	if (config->core.memory_budget != 0 && config->core.memory_budget < (4 * 1024 * 1024)) {
+		fprintf(stderr, "Invalid memory_budget: %zu (must be 0 or at least 4MB)\n",
+		        config->core.memory_budget);
+		return NLMON_CONFIG_ERR_VALIDATION;
+	}
+	
+	if (config->core.stall_ms != 0 && config->core.stall_ms < 100) {
+		fprintf(stderr, "Invalid watchdog stall_ms: %u (must be 0 or at least 100)\n",
+		        config->core.stall_ms);
+		return NLMON_CONFIG_ERR_VALIDATION;
+	}
+	
 	if (config->core.rate_limit < 0 || config->core.rate_limit > 100000) {
 		fprintf(stderr, "Invalid rate_limit: %d (must be between 0 and 100000)\n",
 		        config->core.rate_limit);
 		return NLMON_CONFIG_ERR_VALIDATION;
 	}
 	
+	if (config->core.global_rate_limit < 0 || config->core.global_rate_limit > 100000 ||
+	    config->core.interface_rate_limit < 0 || config->core.interface_rate_limit > 100000 ||
+	    config->core.genl_family_rate_limit < 0 || config->core.genl_family_rate_limit > 100000) {
+		fprintf(stderr, "Invalid rate_limits: global %d, interface %d, genl_family %d "
+		        "(must be between 0 and 100000)\n", config->core.global_rate_limit,
+		        config->core.interface_rate_limit, config->core.genl_family_rate_limit);
+		return NLMON_CONFIG_ERR_VALIDATION;
+	}
+	
+	if (config->core.rate_limit_keys < 1 || config->core.rate_limit_keys > 1048576) {
+		fprintf(stderr, "Invalid rate_limits keys: %d (must be between 1 and 1048576)\n",
+		        config->core.rate_limit_keys);
+		return NLMON_CONFIG_ERR_VALIDATION;
+	}
+	
 	if (config->core.worker_threads < 1 || config->core.worker_threads > 64) {
 		fprintf(stderr, "Invalid worker_threads: %d (must be between 1 and 64)\n",
 		        config->core.worker_threads);
@@ -214,6 +277,30 @@ int nlmon_config_validate(const struct nlmon_config *config)
 		}
 	}
 	
+	/* Validate thread placement configuration */
+	{
+		const struct {
+			const char *name;
+			const char *cpus;
+		} lists[] = {
+			{ "dispatcher_cpus", config->threads.dispatcher_cpus },
+			{ "worker_cpus", config->threads.worker_cpus },
+			{ "web_cpus", config->threads.web_cpus },
+			{ "metrics_cpus", config->threads.metrics_cpus },
+			{ "retention_cpus", config->threads.retention_cpus },
+			{ "wmi_cpus", config->threads.wmi_cpus },
+		};
+		size_t i;
+		
+		for (i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+			if (!thread_affinity_valid(lists[i].cpus)) {
+				fprintf(stderr, "Invalid CPU list for threads.%s: %s\n",
+				        lists[i].name, lists[i].cpus);
+				return NLMON_CONFIG_ERR_VALIDATION;
+			}
+		}
+	}
+	
 	/* Validate netlink configuration */
 	if (config->netlink.buffer_size.receive < 4096 || 
 	    config->netlink.buffer_size.receive > (10 * 1024 * 1024)) {
@@ -229,6 +316,13 @@ int nlmon_config_validate(const struct nlmon_config *config)
 		return NLMON_CONFIG_ERR_VALIDATION;
 	}
 	
+	if (config->netlink.buffer_size.receive_max < config->netlink.buffer_size.receive ||
+	    config->netlink.buffer_size.receive_max > (64 * 1024 * 1024)) {
+		fprintf(stderr, "Invalid netlink receive_max: %zu (must be between receive size and 64MB)\n",
+		        config->netlink.buffer_size.receive_max);
+		return NLMON_CONFIG_ERR_VALIDATION;
+	}
+	
 	if (config->netlink.multicast_groups.group_count < 0 ||
 	    config->netlink.multicast_groups.group_count > NLMON_MAX_MCAST_GROUPS) {
 		fprintf(stderr, "Invalid multicast group count: %d\n",
@@ -243,6 +337,71 @@ int nlmon_config_validate(const struct nlmon_config *config)
 		return NLMON_CONFIG_ERR_VALIDATION;
 	}
 	
+	if (!config->netlink.conntrack.events_new &&
+	    !config->netlink.conntrack.events_update &&
+	    !config->netlink.conntrack.events_destroy) {
+		fprintf(stderr, "Invalid conntrack events: at least one of new, update and destroy is needed\n");
+		return NLMON_CONFIG_ERR_VALIDATION;
+	}
+	
+	if (config->netlink.conntrack.l3proto != 0 &&
+	    config->netlink.conntrack.l3proto != AF_INET &&
+	    config->netlink.conntrack.l3proto != AF_INET6) {
+		fprintf(stderr, "Invalid conntrack l3proto: %d (must be ipv4 or ipv6)\n",
+		        config->netlink.conntrack.l3proto);
+		return NLMON_CONFIG_ERR_VALIDATION;
+	}
+	
+	if (config->netlink.conntrack.l4proto < 0 || config->netlink.conntrack.l4proto > 255) {
+		fprintf(stderr, "Invalid conntrack l4proto: %d (must be between 0 and 255)\n",
+		        config->netlink.conntrack.l4proto);
+		return NLMON_CONFIG_ERR_VALIDATION;
+	}
+	
+	if (config->netlink.conntrack.zone < -1 || config->netlink.conntrack.zone > 65535) {
+		fprintf(stderr, "Invalid conntrack zone: %d (must be between 0 and 65535)\n",
+		        config->netlink.conntrack.zone);
+		return NLMON_CONFIG_ERR_VALIDATION;
+	}
+	
+	if (config->netlink.dispatch.budget == 0 ||
+	    config->netlink.dispatch.route_weight == 0 ||
+	    config->netlink.dispatch.generic_weight == 0 ||
+	    config->netlink.dispatch.sock_diag_weight == 0) {
+		fprintf(stderr, "Invalid netlink dispatch: budget and weights must be at least 1\n");
+		return NLMON_CONFIG_ERR_VALIDATION;
+	}
+	
+	/* Validate capture configuration */
+	if (config->capture.mmap_ring) {
+		long page_size = sysconf(_SC_PAGESIZE);
+		
+		if (page_size <= 0)
+			page_size = 4096;
+		
+		if (config->capture.ring_block_size < (size_t)page_size ||
+		    config->capture.ring_block_size > (64 * 1024 * 1024) ||
+		    config->capture.ring_block_size % (size_t)page_size != 0) {
+			fprintf(stderr, "Invalid capture ring_block_size: %zu (must be a multiple of %ld up to 64MB)\n",
+			        config->capture.ring_block_size, page_size);
+			return NLMON_CONFIG_ERR_VALIDATION;
+		}
+		
+		if (config->capture.ring_block_count < 2 ||
+		    config->capture.ring_block_count > 1024) {
+			fprintf(stderr, "Invalid capture ring_block_count: %d (must be between 2 and 1024)\n",
+			        config->capture.ring_block_count);
+			return NLMON_CONFIG_ERR_VALIDATION;
+		}
+		
+		if (config->capture.ring_block_timeout_ms < 1 ||
+		    config->capture.ring_block_timeout_ms > 10000) {
+			fprintf(stderr, "Invalid capture ring_block_timeout: %d (must be between 1 and 10000 ms)\n",
+			        config->capture.ring_block_timeout_ms);
+			return NLMON_CONFIG_ERR_VALIDATION;
+		}
+	}
+	
 	return NLMON_CONFIG_OK;
 }
 
@@ -269,6 +428,30 @@ void nlmon_config_apply_env(struct nlmon_config *config)
 			config->core.max_events = (int)val;
 	}
 	
+	env_val = getenv("NLMON_MEMORY_BUDGET");
+	if (env_val) {
+		long val = strtol(env_val, NULL, 10);
+		if (val >= 0)
+			config->core.memory_budget = (size_t)val;
+	}
+	
+	env_val = getenv("NLMON_STALL_MS");
+	if (env_val) {
+		long val = strtol(env_val, NULL, 10);
+		if (val >= 0)
+			config->core.stall_ms = (unsigned int)val;
+	}
+	
+	env_val = getenv("NLMON_HUGEPAGES");
+	if (env_val) {
+		if (strcasecmp(env_val, "thp") == 0)
+			config->core.hugepages = HUGE_ALLOC_THP;
+		else if (strcasecmp(env_val, "hugetlb") == 0)
+			config->core.hugepages = HUGE_ALLOC_HUGETLB;
+		else
+			config->core.hugepages = HUGE_ALLOC_OFF;
+	}
+	
 	env_val = getenv("NLMON_RATE_LIMIT");
 	if (env_val) {
 		long val = strtol(env_val, NULL, 10);
@@ -322,84 +505,158 @@ void nlmon_config_apply_env(struct nlmon_config *config)
 	}
 }
 
+/* Read side sections, see nlmon_config_ctx_reload() for the writer */
+
+const struct nlmon_config *nlmon_config_read_begin(struct nlmon_config_ctx *ctx,
+                                                   unsigned *token)
+{
+	unsigned idx = atomic_load(&ctx->reader_epoch) & 1;
+	
+	atomic_fetch_add(&ctx->readers[idx], 1);
+	*token = idx;
+	return atomic_load(&ctx->current);
+}
+
+void nlmon_config_read_end(struct nlmon_config_ctx *ctx, unsigned token)
+{
+	atomic_fetch_sub(&ctx->readers[token], 1);
+}
+
 /* Type-safe accessor functions */
 
 void nlmon_config_get_core(struct nlmon_config_ctx *ctx, 
                            struct nlmon_core_config *core)
 {
-	if (!ctx || !ctx->current || !core)
+	const struct nlmon_config *config;
+	unsigned token;
+	
+	if (!ctx || !core)
 		return;
 	
-	pthread_rwlock_rdlock(&ctx->current->lock);
-	memcpy(core, &ctx->current->core, sizeof(*core));
-	pthread_rwlock_unlock(&ctx->current->lock);
+	config = nlmon_config_read_begin(ctx, &token);
+	if (config)
+		memcpy(core, &config->core, sizeof(*core));
+	nlmon_config_read_end(ctx, token);
 }
 
 void nlmon_config_get_monitoring(struct nlmon_config_ctx *ctx,
                                  struct nlmon_monitoring_config *monitoring)
 {
-	if (!ctx || !ctx->current || !monitoring)
+	const struct nlmon_config *config;
+	unsigned token;
+	
+	if (!ctx || !monitoring)
 		return;
 	
-	pthread_rwlock_rdlock(&ctx->current->lock);
-	memcpy(monitoring, &ctx->current->monitoring, sizeof(*monitoring));
-	pthread_rwlock_unlock(&ctx->current->lock);
+	config = nlmon_config_read_begin(ctx, &token);
+	if (config)
+		memcpy(monitoring, &config->monitoring, sizeof(*monitoring));
+	nlmon_config_read_end(ctx, token);
 }
 
 void nlmon_config_get_output(struct nlmon_config_ctx *ctx,
                              struct nlmon_output_config *output)
 {
-	if (!ctx || !ctx->current || !output)
+	const struct nlmon_config *config;
+	unsigned token;
+	
+	if (!ctx || !output)
 		return;
 	
-	pthread_rwlock_rdlock(&ctx->current->lock);
-	memcpy(output, &ctx->current->output, sizeof(*output));
-	pthread_rwlock_unlock(&ctx->current->lock);
+	config = nlmon_config_read_begin(ctx, &token);
+	if (config)
+		memcpy(output, &config->output, sizeof(*output));
+	nlmon_config_read_end(ctx, token);
 }
 
 void nlmon_config_get_cli(struct nlmon_config_ctx *ctx,
                           struct nlmon_cli_config *cli)
 {
-	if (!ctx || !ctx->current || !cli)
+	const struct nlmon_config *config;
+	unsigned token;
+	
+	if (!ctx || !cli)
 		return;
 	
-	pthread_rwlock_rdlock(&ctx->current->lock);
-	memcpy(cli, &ctx->current->cli, sizeof(*cli));
-	pthread_rwlock_unlock(&ctx->current->lock);
+	config = nlmon_config_read_begin(ctx, &token);
+	if (config)
+		memcpy(cli, &config->cli, sizeof(*cli));
+	nlmon_config_read_end(ctx, token);
 }
 
 void nlmon_config_get_web(struct nlmon_config_ctx *ctx,
                           struct nlmon_web_config *web)
 {
-	if (!ctx || !ctx->current || !web)
+	const struct nlmon_config *config;
+	unsigned token;
+	
+	if (!ctx || !web)
 		return;
 	
-	pthread_rwlock_rdlock(&ctx->current->lock);
-	memcpy(web, &ctx->current->web, sizeof(*web));
-	pthread_rwlock_unlock(&ctx->current->lock);
+	config = nlmon_config_read_begin(ctx, &token);
+	if (config)
+		memcpy(web, &config->web, sizeof(*web));
+	nlmon_config_read_end(ctx, token);
 }
 
 void nlmon_config_get_netlink(struct nlmon_config_ctx *ctx,
                               struct nlmon_netlink_config *netlink)
 {
-	if (!ctx || !ctx->current || !netlink)
+	const struct nlmon_config *config;
+	unsigned token;
+	
+	if (!ctx || !netlink)
+		return;
+	
+	config = nlmon_config_read_begin(ctx, &token);
+	if (config)
+		memcpy(netlink, &config->netlink, sizeof(*netlink));
+	nlmon_config_read_end(ctx, token);
+}
+
+void nlmon_config_get_threads(struct nlmon_config_ctx *ctx,
+                              struct nlmon_threads_config *threads)
+{
+	const struct nlmon_config *config;
+	unsigned token;
+	
+	if (!ctx || !threads)
+		return;
+	
+	config = nlmon_config_read_begin(ctx, &token);
+	if (config)
+		memcpy(threads, &config->threads, sizeof(*threads));
+	nlmon_config_read_end(ctx, token);
+}
+
+void nlmon_config_get_capture(struct nlmon_config_ctx *ctx,
+                              struct nlmon_capture_config *capture)
+{
+	const struct nlmon_config *config;
+	unsigned token;
+	
+	if (!ctx || !capture)
 		return;
 	
-	pthread_rwlock_rdlock(&ctx->current->lock);
-	memcpy(netlink, &ctx->current->netlink, sizeof(*netlink));
-	pthread_rwlock_unlock(&ctx->current->lock);
+	config = nlmon_config_read_begin(ctx, &token);
+	if (config)
+		memcpy(capture, &config->capture, sizeof(*capture));
+	nlmon_config_read_end(ctx, token);
 }
 
 uint64_t nlmon_config_get_version(struct nlmon_config_ctx *ctx)
 {
-	uint64_t version;
+	const struct nlmon_config *config;
+	uint64_t version = 0;
+	unsigned token;
 	
-	if (!ctx || !ctx->current)
+	if (!ctx)
 		return 0;
 	
-	pthread_rwlock_rdlock(&ctx->current->lock);
-	version = ctx->current->version;
-	pthread_rwlock_unlock(&ctx->current->lock);
+	config = nlmon_config_read_begin(ctx, &token);
+	if (config)
+		version = config->version;
+	nlmon_config_read_end(ctx, token);
 	
 	return version;
 }
@@ -408,6 +665,8 @@ uint64_t nlmon_config_get_version(struct nlmon_config_ctx *ctx)
 
 int nlmon_config_ctx_init(struct nlmon_config_ctx *ctx, const char *config_file)
 {
+	struct nlmon_config *config;
+	uint64_t start = nlmon_clock_precise_ns(), validated;
 	int ret;
 	
 	if (!ctx)
@@ -416,50 +675,53 @@ int nlmon_config_ctx_init(struct nlmon_config_ctx *ctx, const char *config_file)
 	memset(ctx, 0, sizeof(*ctx));
 	
 	/* Allocate current configuration */
-	ctx->current = calloc(1, sizeof(struct nlmon_config));
-	if (!ctx->current)
+	config = calloc(1, sizeof(struct nlmon_config));
+	if (!config)
 		return NLMON_CONFIG_ERR_NOMEM;
 	
 	/* Initialize with defaults */
-	ret = nlmon_config_init(ctx->current);
+	ret = nlmon_config_init(config);
 	if (ret != NLMON_CONFIG_OK) {
-		free(ctx->current);
-		ctx->current = NULL;
+		free(config);
 		return ret;
 	}
 	
 	/* Load configuration from file if provided */
 	if (config_file) {
-		strncpy(ctx->current->config_file, config_file, 
-		        sizeof(ctx->current->config_file) - 1);
+		strncpy(config->config_file, config_file, 
+		        sizeof(config->config_file) - 1);
 		
-		ret = nlmon_config_load(ctx->current, config_file);
+		ret = nlmon_config_load(config, config_file);
 		if (ret != NLMON_CONFIG_OK) {
 			fprintf(stderr, "Warning: Failed to load config from %s, using defaults\n",
 			        config_file);
 		}
 	}
 	
+	ctx->timing.load_ns = nlmon_clock_precise_ns() - start;
+	
 	/* Apply environment variable overrides */
-	nlmon_config_apply_env(ctx->current);
+	nlmon_config_apply_env(config);
 	
 	/* Validate configuration */
-	ret = nlmon_config_validate(ctx->current);
+	ret = nlmon_config_validate(config);
 	if (ret != NLMON_CONFIG_OK) {
-		nlmon_config_free(ctx->current);
-		free(ctx->current);
-		ctx->current = NULL;
+		nlmon_config_free(config);
+		free(config);
 		return ret;
 	}
+	validated = nlmon_clock_precise_ns();
+	ctx->timing.validate_ns = validated - start - ctx->timing.load_ns;
+	ctx->timing.total_ns = validated - start;
 	
 	/* Initialize swap mutex */
 	if (pthread_mutex_init(&ctx->swap_mutex, NULL) != 0) {
-		nlmon_config_free(ctx->current);
-		free(ctx->current);
-		ctx->current = NULL;
+		nlmon_config_free(config);
+		free(config);
 		return NLMON_CONFIG_ERR_NOMEM;
 	}
 	
+	atomic_init(&ctx->current, config);
 	ctx->watch_fd = -1;
 	ctx->watch_wd = -1;
 	ctx->reload_requested = false;
@@ -467,6 +729,35 @@ int nlmon_config_ctx_init(struct nlmon_config_ctx *ctx, const char *config_file)
 	return NLMON_CONFIG_OK;
 }
 
+int nlmon_config_ctx_set_prepare(struct nlmon_config_ctx *ctx,
+                                 int (*prepare)(struct nlmon_config *config, void *arg),
+                                 void *arg)
+{
+	struct nlmon_config *config;
+	int ret = 0;
+	
+	if (!ctx)
+		return NLMON_CONFIG_ERR_INVALID_VALUE;
+	
+	pthread_mutex_lock(&ctx->swap_mutex);
+	ctx->prepare = prepare;
+	ctx->prepare_arg = arg;
+	
+	/* Nothing reads the snapshot yet, it can still be changed */
+	config = atomic_load(&ctx->current);
+	if (prepare && config) {
+		uint64_t start = nlmon_clock_precise_ns();
+		
+		if (prepare(config, arg) < 0)
+			ret = NLMON_CONFIG_ERR_INVALID_VALUE;
+		ctx->timing.prepare_ns = nlmon_clock_precise_ns() - start;
+		ctx->timing.total_ns += ctx->timing.prepare_ns;
+	}
+	pthread_mutex_unlock(&ctx->swap_mutex);
+	
+	return ret;
+}
+
 void nlmon_config_ctx_free(struct nlmon_config_ctx *ctx)
 {
 	if (!ctx)
@@ -479,10 +770,11 @@ void nlmon_config_ctx_free(struct nlmon_config_ctx *ctx)
 		close(ctx->watch_fd);
 	}
 	
-	/* Free configurations */
+	/* Free configurations, no reader may be left */
 	if (ctx->current) {
 		nlmon_config_free(ctx->current);
 		free(ctx->current);
+		ctx->current = NULL;
 	}
 	
 	if (ctx->pending) {
@@ -18,8 +18,10 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sched.h>
 #include <sys/inotify.h>
 #include "nlmon_config.h"
+#include "nlmon_clock.h"
 
 #define INOTIFY_EVENT_SIZE (sizeof(struct inotify_event))
 #define INOTIFY_BUF_LEN (1024 * (INOTIFY_EVENT_SIZE + 16))
@@ -123,16 +125,31 @@ bool nlmon_config_watch_check(struct nlmon_config_ctx *ctx)
 	return changed;
 }
 
+/* Wait until no read side section can still see a replaced snapshot */
+static void synchronize(struct nlmon_config_ctx *ctx)
+{
+	for (int flip = 0; flip < 2; flip++) {
+		unsigned idx = atomic_fetch_add(&ctx->reader_epoch, 1) & 1;
+		
+		while (atomic_load(&ctx->readers[idx]) != 0)
+			sched_yield();
+	}
+}
+
 /* Reload configuration from file */
 int nlmon_config_ctx_reload(struct nlmon_config_ctx *ctx)
 {
 	struct nlmon_config *new_config;
 	struct nlmon_config *old_config;
+	struct nlmon_config_timing timing = { 0 };
+	uint64_t start, stage;
 	int ret;
 	
 	if (!ctx || !ctx->current)
 		return NLMON_CONFIG_ERR_INVALID_VALUE;
 	
+	start = stage = nlmon_clock_precise_ns();
+	
 	fprintf(stderr, "Reloading configuration from %s\n", ctx->current->config_file);
 	
 	/* Allocate new configuration */
@@ -165,6 +182,9 @@ int nlmon_config_ctx_reload(struct nlmon_config_ctx *ctx)
 		return ret;
 	}
 	
+	timing.load_ns = nlmon_clock_precise_ns() - stage;
+	stage += timing.load_ns;
+	
 	/* Apply environment variable overrides */
 	nlmon_config_apply_env(new_config);
 	
@@ -178,39 +198,65 @@ int nlmon_config_ctx_reload(struct nlmon_config_ctx *ctx)
 		return ret;
 	}
 	
-	/* Increment version number */
-	new_config->version = ctx->current->version + 1;
+	timing.validate_ns = nlmon_clock_precise_ns() - stage;
+	stage += timing.validate_ns;
 	
-	/* Atomic swap of configurations */
 	pthread_mutex_lock(&ctx->swap_mutex);
 	
-	/* Store old config for cleanup */
-	old_config = ctx->current;
+	/* Derived state, such as compiled filters, is built before the swap */
+	if (ctx->prepare && ctx->prepare(new_config, ctx->prepare_arg) < 0) {
+		pthread_mutex_unlock(&ctx->swap_mutex);
+		fprintf(stderr, "New configuration rejected while preparing it\n");
+		nlmon_config_free(new_config);
+		free(new_config);
+		return NLMON_CONFIG_ERR_INVALID_VALUE;
+	}
 	
-	/* Swap to new config */
-	ctx->current = new_config;
+	/* Waiting for the lock counts as preparing */
+	timing.prepare_ns = nlmon_clock_precise_ns() - stage;
+	stage += timing.prepare_ns;
+	
+	/* Increment version number */
+	new_config->version = atomic_load(&ctx->current)->version + 1;
+	
+	/* Publish, readers see the old or the new snapshot whole */
+	old_config = atomic_exchange(&ctx->current, new_config);
 	
 	/* Clear reload flag */
 	ctx->reload_requested = false;
 	
+	/* Readers that might still use the old snapshot finish first */
+	synchronize(ctx);
+	
+	timing.publish_ns = nlmon_clock_precise_ns() - stage;
+	timing.total_ns = stage + timing.publish_ns - start;
+	timing.reloads = ctx->timing.reloads + 1;
+	ctx->timing = timing;
+	
 	pthread_mutex_unlock(&ctx->swap_mutex);
 	
 	fprintf(stderr, "Configuration reloaded successfully (version %lu)\n",
 	        (unsigned long)new_config->version);
 	
-	/* Wait a bit to ensure no threads are using old config */
-	/* In a real implementation, we'd use RCU or reference counting */
-	usleep(100000); /* 100ms */
-	
 	/* Free old configuration */
-	if (old_config) {
-		nlmon_config_free(old_config);
-		free(old_config);
-	}
+	nlmon_config_free(old_config);
+	free(old_config);
 	
 	return NLMON_CONFIG_OK;
 }
 
+/* Get the stage times of the last load or reload */
+void nlmon_config_ctx_get_timing(struct nlmon_config_ctx *ctx,
+                                 struct nlmon_config_timing *timing)
+{
+	if (!ctx || !timing)
+		return;
+	
+	pthread_mutex_lock(&ctx->swap_mutex);
+	*timing = ctx->timing;
+	pthread_mutex_unlock(&ctx->swap_mutex);
+}
+
 /* Get file descriptor for select/poll integration */
 int nlmon_config_watch_get_fd(struct nlmon_config_ctx *ctx)
 {
@@ -16,8 +16,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include <yaml.h>
 #include "nlmon_config.h"
+#include "huge_alloc.h"
 
 /* Parser context */
 struct yaml_parse_ctx {
@@ -104,15 +108,68 @@ static bool parse_bool(const char *value)
 	        strcmp(value, "1") == 0);
 }
 
+/* Parse a huge page mode, see enum huge_alloc_mode */
+static int parse_hugepage_mode(const char *value)
+{
+	if (strcasecmp(value, "thp") == 0)
+		return HUGE_ALLOC_THP;
+	if (strcasecmp(value, "hugetlb") == 0)
+		return HUGE_ALLOC_HUGETLB;
+	return HUGE_ALLOC_OFF;
+}
+
+/* Parse an address family name or number, -1 if unknown */
+static int parse_l3proto(const char *value)
+{
+	char *endptr;
+	long num;
+	
+	if (strcasecmp(value, "ipv4") == 0 || strcasecmp(value, "inet") == 0)
+		return AF_INET;
+	if (strcasecmp(value, "ipv6") == 0 || strcasecmp(value, "inet6") == 0)
+		return AF_INET6;
+	
+	num = strtol(value, &endptr, 10);
+	return *endptr == '\0' ? (int)num : -1;
+}
+
+/* Parse an IP protocol name or number, -1 if unknown */
+static int parse_l4proto(const char *value)
+{
+	static const struct {
+		const char *name;
+		int proto;
+	} names[] = {
+		{ "icmp", IPPROTO_ICMP }, { "tcp", IPPROTO_TCP }, { "udp", IPPROTO_UDP },
+		{ "dccp", IPPROTO_DCCP }, { "gre", IPPROTO_GRE }, { "icmpv6", IPPROTO_ICMPV6 },
+		{ "sctp", IPPROTO_SCTP }, { "udplite", IPPROTO_UDPLITE },
+	};
+	char *endptr;
+	long num;
+	size_t i;
+	
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (strcasecmp(value, names[i].name) == 0)
+			return names[i].proto;
+	}
+	
+	num = strtol(value, &endptr, 10);
+	return *endptr == '\0' ? (int)num : -1;
+}
+
 /* Parse scalar value based on current context */
 static int parse_scalar_value(struct yaml_parse_ctx *ctx, const char *value)
 {
 	struct nlmon_config *cfg = ctx->config;
-	char expanded[NLMON_MAX_PATH];
+	char buf[NLMON_MAX_PATH];
+	const char *expanded = value;
 	const char *section;
 	
 	/* Expand environment variables */
-	expand_env_vars(expanded, sizeof(expanded), value);
+	if (strstr(value, "${")) {
+		expand_env_vars(buf, sizeof(buf), value);
+		expanded = buf;
+	}
 	
 	/* Determine the actual section to use
 	 * If section is "nlmon", use subsection as the section
@@ -126,8 +183,34 @@ static int parse_scalar_value(struct yaml_parse_ctx *ctx, const char *value)
 	
 	/* Core configuration */
 	if (strcmp(section, "core") == 0) {
-		if (strcmp(ctx->key, "buffer_size") == 0) {
+		if (strcmp(ctx->subsubsection, "rate_limits") == 0) {
+			if (strcmp(ctx->key, "global") == 0) {
+				cfg->core.global_rate_limit = atoi(expanded);
+			} else if (strcmp(ctx->key, "interface") == 0) {
+				cfg->core.interface_rate_limit = atoi(expanded);
+			} else if (strcmp(ctx->key, "genl_family") == 0) {
+				cfg->core.genl_family_rate_limit = atoi(expanded);
+			} else if (strcmp(ctx->key, "keys") == 0) {
+				cfg->core.rate_limit_keys = atoi(expanded);
+			}
+		} else if (strcmp(ctx->subsubsection, "watchdog") == 0) {
+			if (strcmp(ctx->key, "stall_ms") == 0) {
+				cfg->core.stall_ms = (unsigned int)atoi(expanded);
+			} else if (strcmp(ctx->key, "restart") == 0) {
+				cfg->core.stall_restart = parse_bool(expanded);
+			}
+		} else if (strcmp(ctx->subsubsection, "hugepages") == 0) {
+			if (strcmp(ctx->key, "mode") == 0) {
+				cfg->core.hugepages = parse_hugepage_mode(expanded);
+			} else if (strcmp(ctx->key, "min_size") == 0) {
+				cfg->core.hugepage_min_size = parse_size(expanded);
+			} else if (strcmp(ctx->key, "prefault") == 0) {
+				cfg->core.hugepage_prefault = parse_bool(expanded);
+			}
+		} else if (strcmp(ctx->key, "buffer_size") == 0) {
 			cfg->core.buffer_size = parse_size(expanded);
+		} else if (strcmp(ctx->key, "memory_budget") == 0) {
+			cfg->core.memory_budget = parse_size(expanded);
 		} else if (strcmp(ctx->key, "max_events") == 0) {
 			cfg->core.max_events = atoi(expanded);
 		} else if (strcmp(ctx->key, "rate_limit") == 0) {
@@ -168,6 +251,19 @@ static int parse_scalar_value(struct yaml_parse_ctx *ctx, const char *value)
 			}
 		}
 	}
+	/* nlmon device capture configuration */
+	else if (strcmp(section, "capture") == 0) {
+		if (strcmp(ctx->key, "mmap_ring") == 0) {
+			cfg->capture.mmap_ring = parse_bool(expanded);
+		} else if (strcmp(ctx->key, "ring_block_size") == 0) {
+			cfg->capture.ring_block_size = parse_size(expanded);
+		} else if (strcmp(ctx->key, "ring_block_count") == 0) {
+			cfg->capture.ring_block_count = atoi(expanded);
+		} else if (strcmp(ctx->key, "ring_block_timeout") == 0) {
+			/* Parse milliseconds from string like "64ms" */
+			cfg->capture.ring_block_timeout_ms = atoi(expanded);
+		}
+	}
 	/* Output configuration */
 	else if (strcmp(section, "output") == 0) {
 		if (strcmp(ctx->subsubsection, "console") == 0) {
@@ -239,6 +335,26 @@ static int parse_scalar_value(struct yaml_parse_ctx *ctx, const char *value)
 			        sizeof(cfg->metrics.path) - 1);
 		}
 	}
+	/* Thread placement configuration */
+	else if (strcmp(section, "threads") == 0) {
+		char *field = NULL;
+		
+		if (strcmp(ctx->key, "dispatcher_cpus") == 0)
+			field = cfg->threads.dispatcher_cpus;
+		else if (strcmp(ctx->key, "worker_cpus") == 0)
+			field = cfg->threads.worker_cpus;
+		else if (strcmp(ctx->key, "web_cpus") == 0)
+			field = cfg->threads.web_cpus;
+		else if (strcmp(ctx->key, "metrics_cpus") == 0)
+			field = cfg->threads.metrics_cpus;
+		else if (strcmp(ctx->key, "retention_cpus") == 0)
+			field = cfg->threads.retention_cpus;
+		else if (strcmp(ctx->key, "wmi_cpus") == 0)
+			field = cfg->threads.wmi_cpus;
+		
+		if (field)
+			strncpy(field, expanded, NLMON_MAX_CPULIST - 1);
+	}
 	/* Plugins configuration */
 	else if (strcmp(section, "plugins") == 0) {
 		if (strcmp(ctx->key, "directory") == 0) {
@@ -274,6 +390,10 @@ static int parse_scalar_value(struct yaml_parse_ctx *ctx, const char *value)
 				cfg->netlink.buffer_size.receive = parse_size(expanded);
 			} else if (strcmp(ctx->key, "send") == 0) {
 				cfg->netlink.buffer_size.send = parse_size(expanded);
+			} else if (strcmp(ctx->key, "autotune") == 0) {
+				cfg->netlink.buffer_size.autotune = parse_bool(expanded);
+			} else if (strcmp(ctx->key, "receive_max") == 0) {
+				cfg->netlink.buffer_size.receive_max = parse_size(expanded);
 			}
 		} else if (strcmp(ctx->subsubsection, "caching") == 0) {
 			if (strcmp(ctx->key, "enabled") == 0) {
@@ -285,6 +405,34 @@ static int parse_scalar_value(struct yaml_parse_ctx *ctx, const char *value)
 			} else if (strcmp(ctx->key, "route_cache") == 0) {
 				cfg->netlink.caching.route_cache = parse_bool(expanded);
 			}
+		} else if (strcmp(ctx->subsubsection, "conntrack") == 0) {
+			if (strcmp(ctx->key, "new") == 0) {
+				cfg->netlink.conntrack.events_new = parse_bool(expanded);
+			} else if (strcmp(ctx->key, "update") == 0) {
+				cfg->netlink.conntrack.events_update = parse_bool(expanded);
+			} else if (strcmp(ctx->key, "destroy") == 0) {
+				cfg->netlink.conntrack.events_destroy = parse_bool(expanded);
+			} else if (strcmp(ctx->key, "l3proto") == 0) {
+				cfg->netlink.conntrack.l3proto = parse_l3proto(expanded);
+			} else if (strcmp(ctx->key, "l4proto") == 0) {
+				cfg->netlink.conntrack.l4proto = parse_l4proto(expanded);
+			} else if (strcmp(ctx->key, "zone") == 0) {
+				cfg->netlink.conntrack.zone = atoi(expanded);
+			} else if (strcmp(ctx->key, "mark") == 0) {
+				cfg->netlink.conntrack.mark = (uint32_t)strtoul(expanded, NULL, 0);
+			} else if (strcmp(ctx->key, "mark_mask") == 0) {
+				cfg->netlink.conntrack.mark_mask = (uint32_t)strtoul(expanded, NULL, 0);
+			}
+		} else if (strcmp(ctx->subsubsection, "dispatch") == 0) {
+			if (strcmp(ctx->key, "budget") == 0) {
+				cfg->netlink.dispatch.budget = (unsigned int)atoi(expanded);
+			} else if (strcmp(ctx->key, "route_weight") == 0) {
+				cfg->netlink.dispatch.route_weight = (unsigned int)atoi(expanded);
+			} else if (strcmp(ctx->key, "generic_weight") == 0) {
+				cfg->netlink.dispatch.generic_weight = (unsigned int)atoi(expanded);
+			} else if (strcmp(ctx->key, "sock_diag_weight") == 0) {
+				cfg->netlink.dispatch.sock_diag_weight = (unsigned int)atoi(expanded);
+			}
 		} else if (strcmp(ctx->subsubsection, "multicast_groups") == 0 && ctx->in_array) {
 			if (cfg->netlink.multicast_groups.group_count < NLMON_MAX_MCAST_GROUPS) {
 				strncpy(cfg->netlink.multicast_groups.groups[cfg->netlink.multicast_groups.group_count],
@@ -352,6 +500,20 @@ static int parse_scalar_value(struct yaml_parse_ctx *ctx, const char *value)
 					hook->enabled = parse_bool(expanded);
 				} else if (strcmp(ctx->key, "async") == 0) {
 					hook->async = parse_bool(expanded);
+				} else if (strcmp(ctx->key, "persistent") == 0) {
+					hook->persistent = parse_bool(expanded);
+				} else if (strcmp(ctx->key, "max_concurrent") == 0) {
+					hook->max_concurrent = (uint32_t)atoi(expanded);
+				} else if (strcmp(ctx->key, "batch_count") == 0) {
+					hook->batch_count = (uint32_t)atoi(expanded);
+				} else if (strcmp(ctx->key, "batch_interval_ms") == 0) {
+					hook->batch_interval_ms = (uint32_t)atoi(expanded);
+				} else if (strcmp(ctx->key, "queue_size") == 0) {
+					hook->queue_size = (uint32_t)atoi(expanded);
+				} else if (strcmp(ctx->key, "overflow") == 0) {
+					strncpy(hook->overflow, expanded, sizeof(hook->overflow) - 1);
+				} else if (strcmp(ctx->key, "sample_rate") == 0) {
+					hook->sample_rate = (uint32_t)atoi(expanded);
 				}
 			}
 		}
@@ -360,14 +522,135 @@ static int parse_scalar_value(struct yaml_parse_ctx *ctx, const char *value)
 	return NLMON_CONFIG_OK;
 }
 
-/* Parse YAML document */
+/* Position in the document, kept across events */
+struct yaml_doc_state {
+	int in_mapping;
+	int mapping_level;
+	char last_key[128];
+};
+
+/* Apply one parser event to the configuration, value is set for scalars.
+ * Returns true at the end of the document. */
+static bool handle_event(struct yaml_parse_ctx *ctx, struct yaml_doc_state *st,
+                         yaml_event_type_t type, const char *value)
+{
+	switch (type) {
+	case YAML_STREAM_START_EVENT:
+	case YAML_DOCUMENT_START_EVENT:
+		break;
+		
+	case YAML_MAPPING_START_EVENT:
+		st->in_mapping++;
+		st->mapping_level++;
+		/* If we have a pending key, it becomes the section/subsection/subsubsection */
+		if (st->last_key[0] != '\0') {
+			if (st->mapping_level == 2) {
+				strncpy(ctx->subsection, st->last_key, sizeof(ctx->subsection) - 1);
+				ctx->subsubsection[0] = '\0';
+			} else if (st->mapping_level == 3) {
+				strncpy(ctx->subsubsection, st->last_key, sizeof(ctx->subsubsection) - 1);
+			}
+			st->last_key[0] = '\0';
+		}
+		break;
+		
+	case YAML_MAPPING_END_EVENT:
+		st->in_mapping--;
+		st->mapping_level--;
+		if (st->mapping_level == 2) {
+			/* Exiting subsubsection */
+			ctx->subsubsection[0] = '\0';
+		} else if (st->mapping_level == 1) {
+			/* Exiting subsection */
+			ctx->subsection[0] = '\0';
+		} else if (st->mapping_level == 0) {
+			/* Exiting section */
+			ctx->section[0] = '\0';
+		} else if (st->mapping_level == 3 && ctx->in_array) {
+			/* Exiting array item (e.g., hook object) */
+			if (strcmp(ctx->subsubsection, "hooks") == 0) {
+				if (ctx->config->integration.hook_count < NLMON_MAX_HOOKS)
+					ctx->config->integration.hook_count++;
+			}
+		}
+		break;
+		
+	case YAML_SEQUENCE_START_EVENT:
+		ctx->in_array = true;
+		ctx->array_index = 0;
+		/* If we have a pending key, it becomes the subsubsection for array items */
+		if (st->last_key[0] != '\0') {
+			if (st->mapping_level == 2) {
+				strncpy(ctx->subsubsection, st->last_key, sizeof(ctx->subsubsection) - 1);
+			}
+			st->last_key[0] = '\0';
+		}
+		break;
+		
+	case YAML_SEQUENCE_END_EVENT:
+		ctx->in_array = false;
+		ctx->array_index = 0;
+		break;
+		
+	case YAML_SCALAR_EVENT:
+		/* If we're in an array and there's no pending key,
+		 * treat scalars as array item values */
+		if (ctx->in_array && st->last_key[0] == '\0') {
+			/* This is an array item value */
+			parse_scalar_value(ctx, value);
+			ctx->array_index++;
+		} else if (st->in_mapping && st->last_key[0] == '\0') {
+			/* This is a key */
+			strncpy(st->last_key, value, sizeof(st->last_key) - 1);
+			
+			if (st->mapping_level == 1) {
+				/* Top-level section */
+				strncpy(ctx->section, value, sizeof(ctx->section) - 1);
+				ctx->subsection[0] = '\0';
+				ctx->subsubsection[0] = '\0';
+			} else if (st->mapping_level == 2) {
+				/* Subsection */
+				strncpy(ctx->subsection, value, sizeof(ctx->subsection) - 1);
+				ctx->subsubsection[0] = '\0';
+			} else if (st->mapping_level == 3) {
+				/* Sub-subsection */
+				strncpy(ctx->subsubsection, value, sizeof(ctx->subsubsection) - 1);
+			} else if (st->mapping_level >= 4) {
+				/* Key in sub-subsection */
+				strncpy(ctx->key, value, sizeof(ctx->key) - 1);
+			}
+		} else {
+			/* This is a value */
+			if (st->mapping_level >= 2) {
+				strncpy(ctx->key, st->last_key, sizeof(ctx->key) - 1);
+			}
+			
+			parse_scalar_value(ctx, value);
+			
+			if (ctx->in_array)
+				ctx->array_index++;
+			
+			st->last_key[0] = '\0';
+		}
+		break;
+		
+	case YAML_STREAM_END_EVENT:
+	case YAML_DOCUMENT_END_EVENT:
+		return true;
+		
+	default:
+		break;
+	}
+	
+	return false;
+}
+
+/* Parse YAML document with libyaml */
 static int parse_yaml_document(struct yaml_parse_ctx *ctx)
 {
+	struct yaml_doc_state st = {0};
 	yaml_event_t event;
-	int done = 0;
-	int in_mapping = 0;
-	int mapping_level = 0;
-	char last_key[128] = {0};
+	bool done = false;
 	
 	while (!done) {
 		if (!yaml_parser_parse(&ctx->parser, &event)) {
@@ -375,123 +658,458 @@ static int parse_yaml_document(struct yaml_parse_ctx *ctx)
 			return NLMON_CONFIG_ERR_PARSE_ERROR;
 		}
 		
-		switch (event.type) {
-		case YAML_STREAM_START_EVENT:
-		case YAML_DOCUMENT_START_EVENT:
-			break;
-			
-		case YAML_MAPPING_START_EVENT:
-			in_mapping++;
-			mapping_level++;
-			/* If we have a pending key, it becomes the section/subsection/subsubsection */
-			if (last_key[0] != '\0') {
-				if (mapping_level == 2) {
-					strncpy(ctx->subsection, last_key, sizeof(ctx->subsection) - 1);
-					ctx->subsubsection[0] = '\0';
-				} else if (mapping_level == 3) {
-					strncpy(ctx->subsubsection, last_key, sizeof(ctx->subsubsection) - 1);
+		done = handle_event(ctx, &st, event.type,
+		                    event.type == YAML_SCALAR_EVENT ?
+		                    (const char *)event.data.scalar.value : NULL);
+		
+		yaml_event_delete(&event);
+	}
+	
+	return NLMON_CONFIG_OK;
+}
+
+/*
+ * In-place parser for block style YAML
+ *
+ * Configuration as written by hand or generated by configuration
+ * management is block style: indented mappings and "- " sequences of
+ * plain or quoted scalars. For those the file is read into one buffer,
+ * scalars are terminated and unquoted where they are, and the events
+ * libyaml would produce go into one array that is applied once the
+ * whole file was accepted, so nothing is allocated per node. Anything
+ * outside that subset (flow collections, anchors, tags, block scalars,
+ * multi-line scalars, several documents) is left to libyaml.
+ */
+
+#define FLAT_MAX_DEPTH 32
+
+enum {
+	FLAT_OK = 0,
+	FLAT_UNSUPPORTED = 1,   /* Needs the full parser */
+	FLAT_NOMEM = -1,
+};
+
+struct flat_event {
+	yaml_event_type_t type;
+	const char *value;
+};
+
+struct flat_doc {
+	struct flat_event *events;
+	size_t count;
+	size_t cap;
+	struct {
+		int indent;
+		bool seq;
+	} stack[FLAT_MAX_DEPTH];
+	int depth;
+	int pending;            /* Indent of a key awaiting a block value, or -1 */
+	bool started;           /* The root collection was opened */
+	bool marker;            /* A document start marker was seen */
+};
+
+#define FLAT_TRY(expr) do { int _r = (expr); if (_r != FLAT_OK) return _r; } while (0)
+
+static int flat_emit(struct flat_doc *doc, yaml_event_type_t type, const char *value)
+{
+	if (doc->count == doc->cap) {
+		size_t cap = doc->cap ? doc->cap * 2 : 64;
+		struct flat_event *events = realloc(doc->events, cap * sizeof(*events));
+		
+		if (!events)
+			return FLAT_NOMEM;
+		doc->events = events;
+		doc->cap = cap;
+	}
+	doc->events[doc->count].type = type;
+	doc->events[doc->count].value = value;
+	doc->count++;
+	return FLAT_OK;
+}
+
+static int flat_push(struct flat_doc *doc, int indent, bool seq)
+{
+	if (doc->depth == FLAT_MAX_DEPTH)
+		return FLAT_UNSUPPORTED;
+	doc->stack[doc->depth].indent = indent;
+	doc->stack[doc->depth].seq = seq;
+	doc->depth++;
+	return flat_emit(doc, seq ? YAML_SEQUENCE_START_EVENT : YAML_MAPPING_START_EVENT, NULL);
+}
+
+static int flat_pop(struct flat_doc *doc)
+{
+	doc->depth--;
+	return flat_emit(doc, doc->stack[doc->depth].seq ?
+	                 YAML_SEQUENCE_END_EVENT : YAML_MAPPING_END_EVENT, NULL);
+}
+
+/* End of a quoted scalar starting at p, past the closing quote, or NULL */
+static char *flat_quote_end(char *p, char *e)
+{
+	char quote = *p++;
+	
+	while (p < e) {
+		if (quote == '"' && *p == '\\' && p + 1 < e) {
+			p += 2;
+		} else if (*p == quote) {
+			if (quote == '\'' && p + 1 < e && p[1] == '\'')
+				p += 2;
+			else
+				return p + 1;
+		} else {
+			p++;
+		}
+	}
+	return NULL;
+}
+
+/* Terminate the scalar [p, e) in place, unquoting it. NULL if it needs
+ * the full parser. */
+static const char *flat_scalar(char *p, char *e)
+{
+	char *out;
+	
+	if (p == e)
+		return "";
+	
+	if (*p == '\'' || *p == '"') {
+		char quote = *p;
+		
+		if (flat_quote_end(p, e) != e)
+			return NULL;
+		out = p;
+		for (char *q = p + 1; q < e - 1; q++) {
+			if (quote == '\'' && *q == '\'') {
+				q++;
+			} else if (quote == '"' && *q == '\\') {
+				switch (*++q) {
+				case '\\': case '"': case '/':
+					break;
+				case 'n':
+					*q = '\n';
+					break;
+				case 't':
+					*q = '\t';
+					break;
+				default:
+					return NULL;
 				}
-				last_key[0] = '\0';
 			}
-			break;
-			
-		case YAML_MAPPING_END_EVENT:
-			in_mapping--;
-			mapping_level--;
-			if (mapping_level == 2) {
-				/* Exiting subsubsection */
-				ctx->subsubsection[0] = '\0';
-			} else if (mapping_level == 1) {
-				/* Exiting subsection */
-				ctx->subsection[0] = '\0';
-			} else if (mapping_level == 0) {
-				/* Exiting section */
-				ctx->section[0] = '\0';
-			} else if (mapping_level == 3 && ctx->in_array) {
-				/* Exiting array item (e.g., hook object) */
-				if (strcmp(ctx->subsubsection, "hooks") == 0) {
-					if (ctx->config->integration.hook_count < NLMON_MAX_HOOKS)
-						ctx->config->integration.hook_count++;
-				}
+			*out++ = *q;
+		}
+		*out = '\0';
+		return p;
+	}
+	
+	/* Indicators that start something other than a plain scalar */
+	if (strchr("[]{},&*!|>%@`?:#", *p) || (*p == '-' && (p + 1 == e || p[1] == ' ')))
+		return NULL;
+	for (char *q = p; q < e; q++)
+		if ((*q == ':' && (q + 1 == e || q[1] == ' ')) ||
+		    (*q == '#' && (q[-1] == ' ' || q[-1] == '\t')))
+			return NULL;
+	
+	*e = '\0';
+	return p;
+}
+
+/* A one line flow sequence of scalars, such as ["eth*", "veth*"] */
+static int flat_flow(struct flat_doc *doc, char *p, char *e)
+{
+	char *end = e - 1;
+	
+	if (*p != '[' || *end != ']')
+		return FLAT_UNSUPPORTED;
+	FLAT_TRY(flat_emit(doc, YAML_SEQUENCE_START_EVENT, NULL));
+	
+	p++;
+	while (p < end && *p == ' ')
+		p++;
+	while (p < end) {
+		char *item = p, *t;
+		const char *value;
+		
+		if (*p == '\'' || *p == '"') {
+			p = flat_quote_end(p, end);
+			if (!p)
+				return FLAT_UNSUPPORTED;
+		} else {
+			while (p < end && *p != ',') {
+				if (strchr("[]{}", *p))
+					return FLAT_UNSUPPORTED;
+				p++;
 			}
+		}
+		t = p;
+		while (t > item && t[-1] == ' ')
+			t--;
+		while (p < end && *p == ' ')
+			p++;
+		if (p < end && *p != ',')
+			return FLAT_UNSUPPORTED;
+		
+		/* The separator is consumed before the item is terminated on it */
+		if (p < end) {
+			p++;
+			while (p < end && *p == ' ')
+				p++;
+			if (p == end)
+				return FLAT_UNSUPPORTED;
+		}
+		
+		value = item < t ? flat_scalar(item, t) : NULL;
+		if (!value)
+			return FLAT_UNSUPPORTED;
+		FLAT_TRY(flat_emit(doc, YAML_SCALAR_EVENT, value));
+	}
+	
+	return flat_emit(doc, YAML_SEQUENCE_END_EVENT, NULL);
+}
+
+/* Colon ending the key of a "key: value" entry in [p, e), or NULL */
+static char *flat_key_colon(char *p, char *e)
+{
+	if (*p == '\'' || *p == '"') {
+		char *q = flat_quote_end(p, e);
+		
+		if (q && q < e && *q == ':' && (q + 1 == e || q[1] == ' '))
+			return q;
+		return NULL;
+	}
+	for (; p < e; p++)
+		if (*p == ':' && (p + 1 == e || p[1] == ' '))
+			return p;
+	return NULL;
+}
+
+/* A "key: value" or "key:" entry of the mapping at indent */
+static int flat_entry(struct flat_doc *doc, int indent, char *p, char *e)
+{
+	char *colon = flat_key_colon(p, e);
+	const char *key, *value;
+	char *v;
+	
+	if (!colon || colon == p)
+		return FLAT_UNSUPPORTED;
+	
+	v = colon + 1;
+	while (v < e && *v == ' ')
+		v++;
+	
+	while (colon > p && colon[-1] == ' ')
+		colon--;
+	key = flat_scalar(p, colon);
+	if (!key)
+		return FLAT_UNSUPPORTED;
+	FLAT_TRY(flat_emit(doc, YAML_SCALAR_EVENT, key));
+	
+	/* The value is a block on the following lines */
+	if (v == e) {
+		doc->pending = indent;
+		return FLAT_OK;
+	}
+	
+	if (*v == '[')
+		return flat_flow(doc, v, e);
+	value = flat_scalar(v, e);
+	if (!value)
+		return FLAT_UNSUPPORTED;
+	return flat_emit(doc, YAML_SCALAR_EVENT, value);
+}
+
+/* One line without indentation and comment, [p, e) is not empty */
+static int flat_line(struct flat_doc *doc, int indent, char *p, char *e)
+{
+	bool item = *p == '-' && (p + 1 == e || p[1] == ' ');
+	
+	/* A key without a value so far opens a block if this line is in it */
+	if (doc->pending >= 0) {
+		int owner = doc->pending;
+		
+		doc->pending = -1;
+		if (item ? indent >= owner : indent > owner) {
+			FLAT_TRY(flat_push(doc, indent, item));
+			goto content;
+		}
+		FLAT_TRY(flat_emit(doc, YAML_SCALAR_EVENT, ""));
+	}
+	
+	/* Close the collections this line is not part of. A sequence may sit
+	 * at the indent of its key, so it also ends at a sibling key. */
+	while (doc->depth > 0) {
+		int top = doc->depth - 1;
+		
+		if (doc->stack[top].indent > indent ||
+		    (doc->stack[top].seq && doc->stack[top].indent == indent && !item))
+			FLAT_TRY(flat_pop(doc));
+		else
 			break;
+	}
+	
+	if (doc->depth == 0) {
+		if (doc->started)
+			return FLAT_UNSUPPORTED;
+		doc->started = true;
+		FLAT_TRY(flat_push(doc, indent, item));
+	} else if (doc->stack[doc->depth - 1].indent != indent ||
+	           doc->stack[doc->depth - 1].seq != item) {
+		return FLAT_UNSUPPORTED;
+	}
+	
+content:
+	if (!item)
+		return flat_entry(doc, indent, p, e);
+	
+	/* "- scalar" or "- key: value" opening a mapping at the key's column */
+	{
+		char *q = p + 1;
+		
+		while (q < e && *q == ' ')
+			q++;
+		if (q == e || (*q == '-' && (q + 1 == e || q[1] == ' ')))
+			return FLAT_UNSUPPORTED;
+		
+		if (flat_key_colon(q, e)) {
+			int column = indent + (int)(q - p);
 			
-		case YAML_SEQUENCE_START_EVENT:
-			ctx->in_array = true;
-			ctx->array_index = 0;
-			/* If we have a pending key, it becomes the subsubsection for array items */
-			if (last_key[0] != '\0') {
-				if (mapping_level == 2) {
-					strncpy(ctx->subsubsection, last_key, sizeof(ctx->subsubsection) - 1);
-				}
-				last_key[0] = '\0';
-			}
-			break;
+			FLAT_TRY(flat_push(doc, column, false));
+			return flat_entry(doc, column, q, e);
+		} else if (*q == '[') {
+			return flat_flow(doc, q, e);
+		} else {
+			const char *value = flat_scalar(q, e);
 			
-		case YAML_SEQUENCE_END_EVENT:
-			ctx->in_array = false;
-			ctx->array_index = 0;
-			break;
+			if (!value)
+				return FLAT_UNSUPPORTED;
+			return flat_emit(doc, YAML_SCALAR_EVENT, value);
+		}
+	}
+}
+
+/* Tokenize the NUL terminated buffer in place into doc->events */
+static int flat_parse(struct flat_doc *doc, char *buf)
+{
+	char *line = buf;
+	
+	doc->pending = -1;
+	FLAT_TRY(flat_emit(doc, YAML_STREAM_START_EVENT, NULL));
+	FLAT_TRY(flat_emit(doc, YAML_DOCUMENT_START_EVENT, NULL));
+	
+	while (*line) {
+		char *eol = strchr(line, '\n');
+		char *next = eol ? eol + 1 : line + strlen(line);
+		char *p = line, *e;
+		bool squote = false, dquote = false;
+		
+		if (!eol)
+			eol = next;
+		
+		while (*p == ' ')
+			p++;
+		if (*p == '\t')
+			return FLAT_UNSUPPORTED;
+		
+		/* Cut a comment, a # outside quotes at the start or after a blank.
+		 * Quotes only open a scalar where one can start. */
+		for (e = p; e < eol; e++) {
+			bool start = e == p || e[-1] == ' ' || e[-1] == '[' || e[-1] == ',';
 			
-		case YAML_SCALAR_EVENT:
-			{
-				const char *value = (const char *)event.data.scalar.value;
-				
-				/* If we're in an array and there's no pending key,
-				 * treat scalars as array item values */
-				if (ctx->in_array && last_key[0] == '\0') {
-					/* This is an array item value */
-					parse_scalar_value(ctx, value);
-					ctx->array_index++;
-				} else if (in_mapping && last_key[0] == '\0') {
-					/* This is a key */
-					strncpy(last_key, value, sizeof(last_key) - 1);
-					
-					if (mapping_level == 1) {
-						/* Top-level section */
-						strncpy(ctx->section, value, sizeof(ctx->section) - 1);
-						ctx->subsection[0] = '\0';
-						ctx->subsubsection[0] = '\0';
-					} else if (mapping_level == 2) {
-						/* Subsection */
-						strncpy(ctx->subsection, value, sizeof(ctx->subsection) - 1);
-						ctx->subsubsection[0] = '\0';
-					} else if (mapping_level == 3) {
-						/* Sub-subsection */
-						strncpy(ctx->subsubsection, value, sizeof(ctx->subsubsection) - 1);
-					} else if (mapping_level >= 4) {
-						/* Key in sub-subsection */
-						strncpy(ctx->key, value, sizeof(ctx->key) - 1);
-					}
-				} else {
-					/* This is a value */
-					if (mapping_level >= 2) {
-						strncpy(ctx->key, last_key, sizeof(ctx->key) - 1);
-					}
-					
-					parse_scalar_value(ctx, value);
-					
-					if (ctx->in_array)
-						ctx->array_index++;
-					
-					last_key[0] = '\0';
-				}
+			if (dquote) {
+				if (*e == '\\' && e + 1 < eol)
+					e++;
+				else if (*e == '"')
+					dquote = false;
+			} else if (squote) {
+				if (*e == '\'' && e + 1 < eol && e[1] == '\'')
+					e++;
+				else if (*e == '\'')
+					squote = false;
+			} else if (*e == '"' && start) {
+				dquote = true;
+			} else if (*e == '\'' && start) {
+				squote = true;
+			} else if (*e == '#' && (start || e[-1] == '\t')) {
+				break;
 			}
-			break;
-			
-		case YAML_STREAM_END_EVENT:
-		case YAML_DOCUMENT_END_EVENT:
-			done = 1;
-			break;
-			
-		default:
-			break;
 		}
+		if (squote || dquote)
+			return FLAT_UNSUPPORTED;
+		while (e > p && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r'))
+			e--;
 		
-		yaml_event_delete(&event);
+		if (e > p) {
+			if (p == line && e - p >= 3 &&
+			    (strncmp(p, "---", 3) == 0 || strncmp(p, "...", 3) == 0) &&
+			    (e - p == 3 || p[3] == ' ')) {
+				/* One document, its start marker may come first */
+				if (doc->started || doc->marker || p[0] == '.' || e - p != 3)
+					return FLAT_UNSUPPORTED;
+				doc->marker = true;
+			} else {
+				FLAT_TRY(flat_line(doc, (int)(p - line), p, e));
+			}
+		}
+		
+		line = next;
 	}
 	
-	return NLMON_CONFIG_OK;
+	/* An explicit document without content is a null scalar */
+	if (doc->marker && !doc->started)
+		return FLAT_UNSUPPORTED;
+	if (doc->pending >= 0)
+		FLAT_TRY(flat_emit(doc, YAML_SCALAR_EVENT, ""));
+	while (doc->depth > 0)
+		FLAT_TRY(flat_pop(doc));
+	FLAT_TRY(flat_emit(doc, YAML_DOCUMENT_END_EVENT, NULL));
+	return flat_emit(doc, YAML_STREAM_END_EVENT, NULL);
+}
+
+/* Read a whole file into one NUL terminated buffer */
+static char *read_file(FILE *file)
+{
+	struct stat st;
+	char *buf;
+	size_t len;
+	
+	if (fstat(fileno(file), &st) < 0 || !S_ISREG(st.st_mode))
+		return NULL;
+	
+	buf = malloc((size_t)st.st_size + 1);
+	if (!buf)
+		return NULL;
+	len = fread(buf, 1, (size_t)st.st_size, file);
+	if (ferror(file) || memchr(buf, '\0', len)) {
+		free(buf);
+		return NULL;
+	}
+	buf[len] = '\0';
+	return buf;
+}
+
+/* Parse with the in-place parser, FLAT_UNSUPPORTED if libyaml must */
+static int parse_flat(struct yaml_parse_ctx *ctx)
+{
+	struct yaml_doc_state st = {0};
+	struct flat_doc doc;
+	char *buf;
+	int ret;
+	
+	buf = read_file(ctx->file);
+	if (!buf)
+		return FLAT_UNSUPPORTED;
+	
+	memset(&doc, 0, sizeof(doc));
+	ret = flat_parse(&doc, buf);
+	if (ret == FLAT_OK) {
+		for (size_t i = 0; i < doc.count; i++)
+			if (handle_event(ctx, &st, doc.events[i].type, doc.events[i].value))
+				break;
+	}
+	
+	free(doc.events);
+	free(buf);
+	return ret;
 }
 
 /* Load configuration from YAML file */
@@ -514,6 +1132,18 @@ int nlmon_config_load(struct nlmon_config *config, const char *filename)
 		return NLMON_CONFIG_ERR_FILE_NOT_FOUND;
 	}
 	
+	/* Block style files need no general parser */
+	ret = parse_flat(&ctx);
+	if (ret == FLAT_OK) {
+		fclose(ctx.file);
+		return NLMON_CONFIG_OK;
+	}
+	if (ret == FLAT_NOMEM) {
+		fclose(ctx.file);
+		return NLMON_CONFIG_ERR_NOMEM;
+	}
+	rewind(ctx.file);
+	
 	/* Initialize YAML parser */
 	if (!yaml_parser_initialize(&ctx.parser)) {
 		fprintf(stderr, "Failed to initialize YAML parser\n");
@@ -0,0 +1,250 @@
+/* adaptive_batch.c - Batch size and linger time steered by latency
+ *
+ * Size moves multiplicatively on latency: a batch over the target takes
+ * a quarter off the size and halves the linger time, a full batch well
+ * within it adds a quarter. Linger follows the stage's duty cycle, the
+ * share of time spent acting on batches. A busy stage saves work by
+ * waiting for more items, so linger doubles up to what the target has
+ * room for; a mostly idle one gains nothing by waiting, so linger halves
+ * down to none and batches go as soon as their items do.
+ *
+ * Size and linger are written by the stage's thread only and read with
+ * relaxed atomics from anywhere.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "adaptive_batch.h"
+#include "stats_bus.h"
+
+#define DEFAULT_MAX_SIZE 256
+#define DEFAULT_TARGET_US 100000
+#define NAME_LEN 32
+
+/* Duty cycle in 1/1024, linger grows from HIGH and shrinks below LOW */
+#define DUTY_HIGH 512
+#define DUTY_LOW 128
+
+/* Linger below this is not worth a timed wait */
+#define LINGER_MIN_NS 1000
+
+struct adaptive_batch {
+	struct adaptive_batch *next;    /* Registry, guarded by registry_lock */
+	char name[NAME_LEN];
+	size_t min_size;
+	size_t max_size;
+	uint64_t target_ns;
+	uint64_t max_linger_ns;
+	
+	_Atomic size_t size;
+	_Atomic uint64_t linger_ns;
+	
+	/* Written by the stage's thread */
+	uint64_t last_ns;               /* Completion of the previous batch */
+	uint64_t cost_avg_ns;
+	uint32_t duty;                  /* Moving average, 1/1024 */
+	_Atomic uint64_t latency_avg_ns;
+	_Atomic uint64_t batches;
+	_Atomic uint64_t items;
+	_Atomic uint64_t over_target;
+	_Atomic uint64_t grows;
+	_Atomic uint64_t shrinks;
+};
+
+static struct adaptive_batch *registry;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct adaptive_batch *adaptive_batch_create(const char *name,
+                                             const struct adaptive_batch_config *config)
+{
+	struct adaptive_batch_config defaults = { 0 };
+	struct adaptive_batch *batch;
+	
+	if (!config)
+		config = &defaults;
+	
+	batch = calloc(1, sizeof(*batch));
+	if (!batch)
+		return NULL;
+	
+	strncpy(batch->name, name ? name : "", sizeof(batch->name) - 1);
+	batch->max_size = config->max_size ? config->max_size : DEFAULT_MAX_SIZE;
+	batch->min_size = config->min_size ? config->min_size : 1;
+	if (batch->min_size > batch->max_size)
+		batch->min_size = batch->max_size;
+	batch->max_linger_ns = config->max_linger_us * 1000;
+	if (config->target_us)
+		batch->target_ns = config->target_us * 1000;
+	else if (batch->max_linger_ns)
+		batch->target_ns = 2 * batch->max_linger_ns;
+	else
+		batch->target_ns = (uint64_t)DEFAULT_TARGET_US * 1000;
+	
+	/* Start where a fixed batcher would be */
+	atomic_init(&batch->size, batch->max_size);
+	atomic_init(&batch->linger_ns, batch->max_linger_ns);
+	
+	pthread_mutex_lock(&registry_lock);
+	batch->next = registry;
+	registry = batch;
+	pthread_mutex_unlock(&registry_lock);
+	
+	return batch;
+}
+
+void adaptive_batch_destroy(struct adaptive_batch *batch)
+{
+	struct adaptive_batch **link;
+	
+	if (!batch)
+		return;
+	
+	pthread_mutex_lock(&registry_lock);
+	for (link = &registry; *link; link = &(*link)->next) {
+		if (*link == batch) {
+			*link = batch->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&registry_lock);
+	
+	free(batch);
+}
+
+size_t adaptive_batch_size(const struct adaptive_batch *batch)
+{
+	return atomic_load_explicit(&batch->size, memory_order_relaxed);
+}
+
+uint64_t adaptive_batch_linger_ns(const struct adaptive_batch *batch)
+{
+	return atomic_load_explicit(&batch->linger_ns, memory_order_relaxed);
+}
+
+/* Longest linger that still leaves the cost of a batch within the target */
+static uint64_t linger_cap(const struct adaptive_batch *batch)
+{
+	uint64_t room = batch->target_ns > batch->cost_avg_ns ?
+	                batch->target_ns - batch->cost_avg_ns : 0;
+	
+	return room < batch->max_linger_ns ? room : batch->max_linger_ns;
+}
+
+void adaptive_batch_record(struct adaptive_batch *batch, size_t count,
+                           uint64_t wait_ns, uint64_t cost_ns, uint64_t now_ns)
+{
+	size_t size = atomic_load_explicit(&batch->size, memory_order_relaxed);
+	uint64_t linger = atomic_load_explicit(&batch->linger_ns, memory_order_relaxed);
+	uint64_t latency = wait_ns + cost_ns;
+	uint64_t avg = atomic_load_explicit(&batch->latency_avg_ns, memory_order_relaxed);
+	uint64_t cap;
+	
+	atomic_fetch_add_explicit(&batch->batches, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&batch->items, count, memory_order_relaxed);
+	atomic_store_explicit(&batch->latency_avg_ns, avg ? avg - avg / 8 + latency / 8 : latency,
+	                      memory_order_relaxed);
+	batch->cost_avg_ns = batch->cost_avg_ns ?
+	                     batch->cost_avg_ns - batch->cost_avg_ns / 8 + cost_ns / 8 : cost_ns;
+	
+	/* Share of the time since the previous batch spent on this one */
+	if (batch->last_ns && now_ns > batch->last_ns) {
+		uint64_t span = now_ns - batch->last_ns;
+		uint32_t duty = cost_ns >= span ? 1024 : (uint32_t)(cost_ns * 1024 / span);
+	
+		batch->duty = (batch->duty * 3 + duty) / 4;
+	}
+	batch->last_ns = now_ns;
+	
+	if (latency > batch->target_ns) {
+		atomic_fetch_add_explicit(&batch->over_target, 1, memory_order_relaxed);
+		if (size > batch->min_size) {
+			size -= size / 4 ? size / 4 : 1;
+			if (size < batch->min_size)
+				size = batch->min_size;
+			atomic_fetch_add_explicit(&batch->shrinks, 1, memory_order_relaxed);
+		}
+		linger /= 2;
+	} else {
+		if (count >= size && size < batch->max_size && latency <= batch->target_ns / 4 * 3) {
+			size += size / 4 + 1;
+			if (size > batch->max_size)
+				size = batch->max_size;
+			atomic_fetch_add_explicit(&batch->grows, 1, memory_order_relaxed);
+		}
+	
+		cap = linger_cap(batch);
+		if (batch->duty >= DUTY_HIGH)
+			linger = linger ? linger * 2 : batch->max_linger_ns / 16;
+		else if (batch->duty < DUTY_LOW)
+			linger /= 2;
+		if (linger > cap)
+			linger = cap;
+	}
+	if (linger < LINGER_MIN_NS)
+		linger = 0;
+	
+	atomic_store_explicit(&batch->size, size, memory_order_relaxed);
+	atomic_store_explicit(&batch->linger_ns, linger, memory_order_relaxed);
+}
+
+void adaptive_batch_get_stats(const struct adaptive_batch *batch,
+                              struct adaptive_batch_stats *stats)
+{
+	stats->name = batch->name;
+	stats->size = atomic_load_explicit(&batch->size, memory_order_relaxed);
+	stats->linger_us = atomic_load_explicit(&batch->linger_ns, memory_order_relaxed) / 1000;
+	stats->target_us = batch->target_ns / 1000;
+	stats->latency_us = atomic_load_explicit(&batch->latency_avg_ns, memory_order_relaxed) / 1000;
+	stats->batches = atomic_load_explicit(&batch->batches, memory_order_relaxed);
+	stats->items = atomic_load_explicit(&batch->items, memory_order_relaxed);
+	stats->over_target = atomic_load_explicit(&batch->over_target, memory_order_relaxed);
+	stats->grows = atomic_load_explicit(&batch->grows, memory_order_relaxed);
+	stats->shrinks = atomic_load_explicit(&batch->shrinks, memory_order_relaxed);
+}
+
+void adaptive_batch_for_each(void (*fn)(const struct adaptive_batch_stats *stats, void *ctx),
+                             void *ctx)
+{
+	struct adaptive_batch_stats stats;
+	
+	if (!fn)
+		return;
+	
+	pthread_mutex_lock(&registry_lock);
+	for (struct adaptive_batch *batch = registry; batch; batch = batch->next) {
+		adaptive_batch_get_stats(batch, &stats);
+		fn(&stats, ctx);
+	}
+	pthread_mutex_unlock(&registry_lock);
+}
+
+static void collect_one(const struct adaptive_batch_stats *stats, void *ctx)
+{
+	struct nlmon_stats_snapshot *snapshot = ctx;
+	struct stats_batch *out;
+	
+	if (snapshot->num_batches >= STATS_BUS_MAX_BATCHES)
+		return;
+	
+	out = &snapshot->batches[snapshot->num_batches++];
+	strncpy(out->name, stats->name, sizeof(out->name) - 1);
+	out->name[sizeof(out->name) - 1] = '\0';
+	out->size = stats->size;
+	out->linger_us = stats->linger_us;
+	out->target_us = stats->target_us;
+	out->latency_us = stats->latency_us;
+	out->batches = stats->batches;
+	out->items = stats->items;
+	out->over_target = stats->over_target;
+}
+
+void adaptive_batch_collect_stats(struct nlmon_stats_snapshot *snapshot, void *ctx)
+{
+	(void)ctx;
+	
+	snapshot->num_batches = 0;
+	adaptive_batch_for_each(collect_one, snapshot);
+	snapshot->have |= STATS_HAVE_BATCHING;
+}
@@ -2,6 +2,20 @@
  *
  * Implements alert rule engine with condition evaluation, action execution,
  * state management, rate limiting, and acknowledgment system.
+ *
+ * Rule changes are serialized by rules_mutex and publish an immutable
+ * snapshot of the enabled rules, indexed by the first event_type,
+ * message_type or interface equality of each condition's top level
+ * conjunction. Evaluation reads the snapshot inside a read side section
+ * as the filter manager does, probes the index with the event's three
+ * values and only evaluates the rules found there and the unindexed
+ * ones, in slot order. Per rule trigger state has its own lock.
+ *
+ * Actions run for digests rather than single events. A trigger outside
+ * its dedup window becomes a digest of one; duplicates within the window
+ * accumulate in the key's pending digest, and actions with a flush
+ * interval merge all digests into one batch. Digests are taken under the
+ * rule's lock and the action runs after it is released.
  */
 
 #include <stdlib.h>
@@ -15,11 +29,36 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <curl/curl.h>
 #include "alert_manager.h"
+#include "event_processor.h"
 #include "filter_parser.h"
 #include "filter_compiler.h"
+#include "filter_cache.h"
 #include "filter_eval.h"
+#include "nlmon_probes.h"
+#include "nlmon_clock.h"
+
+/* Triggers to run an action for once, described by the latest */
+struct alert_digest {
+	uint64_t timestamp;
+	uint64_t sequence;
+	uint32_t event_type;
+	uint16_t message_type;
+	char interface[16];
+	uint64_t first_timestamp;        /* Of the earliest trigger */
+	uint32_t count;                  /* Triggers, 0 if empty */
+	time_t due;                      /* When to run the action */
+};
+
+/* Duplicate key of a rule and its dedup window */
+struct dedup_slot {
+	uint64_t key;
+	time_t window_end;
+	struct alert_digest pending;     /* Duplicates since the action ran */
+};
 
 /* Alert rule entry */
 struct alert_rule_entry {
@@ -28,6 +67,14 @@ struct alert_rule_entry {
 	struct filter_bytecode *filter;  /* Compiled condition */
 	bool in_use;
 	
+	/* Index key, see rule_key() */
+	bool keyed;
+	uint8_t key_field;
+	uint64_t key_value;
+	
+	/* Guards the trigger state and statistics below */
+	pthread_mutex_t lock;
+	
 	/* Rate limiting state */
 	time_t *trigger_times;           /* Circular buffer of trigger times */
 	size_t trigger_count;
@@ -37,6 +84,10 @@ struct alert_rule_entry {
 	bool suppressed;
 	time_t suppress_until;
 	
+	/* Deduplication state */
+	struct dedup_slot *dedup;        /* ALERT_DEDUP_KEYS, NULL without a dedup window */
+	struct alert_digest batch;       /* Digests until the action's flush is due */
+	
 	/* Statistics */
 	unsigned long triggered_count;
 	unsigned long executed_count;
@@ -45,12 +96,32 @@ struct alert_rule_entry {
 	unsigned long rate_limited_count;
 };
 
+/* Index entry of a rule requiring field == value */
+struct rule_key {
+	uint8_t field;
+	uint64_t value;                  /* Number, or hash of the interface name */
+	uint32_t rule;                   /* Slot in rules */
+};
+
+/* Immutable view of the enabled rules */
+struct rule_snapshot {
+	uint32_t *unkeyed;               /* Slots of rules without a key, ascending */
+	size_t unkeyed_count;
+	struct rule_key *keys;           /* Sorted by field, value and slot */
+	size_t key_count;
+};
+
 /* Alert manager structure */
 struct alert_manager {
 	struct alert_rule_entry *rules;
 	size_t max_rules;
 	int next_rule_id;
-	pthread_mutex_t rules_mutex;
+	pthread_mutex_t rules_mutex;     /* Serializes rule changes */
+	
+	/* Published rules, replaced wholesale on every change */
+	_Atomic(struct rule_snapshot *) snapshot;
+	_Atomic unsigned readers[2];     /* Evaluations in progress per epoch */
+	_Atomic unsigned reader_epoch;
 	
 	/* Alert history */
 	struct alert_instance *history;
@@ -63,17 +134,16 @@ struct alert_manager {
 	/* Global statistics */
 	struct alert_stats stats;
 	pthread_mutex_t stats_mutex;
+	
+	_Atomic time_t last_flush;       /* Second of the last flush by evaluation */
+	
+	/* Webhook delivery, started with the first webhook rule */
+	struct webhook_sender *webhooks;
 };
 
-/* Helper: Get current time */
-static time_t get_current_time(void)
-{
-	return time(NULL);
-}
-
 /* Helper: Execute script action */
 static bool execute_script_action(const struct alert_action *action,
-                                  struct nlmon_event *event,
+                                  const struct alert_digest *digest,
                                   const char *alert_name)
 {
 	pid_t pid;
@@ -81,7 +151,7 @@ static bool execute_script_action(const struct alert_action *action,
 	char **envp;
 	int count = 0;
 	char buf[256];
-	time_t start_time;
+	uint64_t start_time;
 	uint32_t timeout_ms = action->params.exec.timeout_ms;
 	
 	if (timeout_ms == 0)
@@ -95,28 +165,35 @@ static bool execute_script_action(const struct alert_action *action,
 	snprintf(buf, sizeof(buf), "NLMON_ALERT_NAME=%s", alert_name);
 	envp[count++] = strdup(buf);
 	
-	snprintf(buf, sizeof(buf), "NLMON_TIMESTAMP=%lu", event->timestamp);
+	snprintf(buf, sizeof(buf), "NLMON_TIMESTAMP=%lu", digest->timestamp);
 	envp[count++] = strdup(buf);
 	
-	snprintf(buf, sizeof(buf), "NLMON_SEQUENCE=%lu", event->sequence);
+	snprintf(buf, sizeof(buf), "NLMON_SEQUENCE=%lu", digest->sequence);
 	envp[count++] = strdup(buf);
 	
-	snprintf(buf, sizeof(buf), "NLMON_EVENT_TYPE=%u", event->event_type);
+	snprintf(buf, sizeof(buf), "NLMON_EVENT_TYPE=%u", digest->event_type);
 	envp[count++] = strdup(buf);
 	
-	snprintf(buf, sizeof(buf), "NLMON_MESSAGE_TYPE=%u", event->message_type);
+	snprintf(buf, sizeof(buf), "NLMON_MESSAGE_TYPE=%u", digest->message_type);
 	envp[count++] = strdup(buf);
 	
-	if (event->interface[0] != '\0') {
-		snprintf(buf, sizeof(buf), "NLMON_INTERFACE=%s", event->interface);
+	if (digest->interface[0] != '\0') {
+		snprintf(buf, sizeof(buf), "NLMON_INTERFACE=%.*s",
+		         (int)sizeof(digest->interface), digest->interface);
 		envp[count++] = strdup(buf);
 	}
 	
+	snprintf(buf, sizeof(buf), "NLMON_ALERT_COUNT=%u", digest->count);
+	envp[count++] = strdup(buf);
+	
+	snprintf(buf, sizeof(buf), "NLMON_FIRST_TIMESTAMP=%lu", digest->first_timestamp);
+	envp[count++] = strdup(buf);
+	
 	envp[count++] = strdup("PATH=/usr/local/bin:/usr/bin:/bin");
 	envp[count] = NULL;
 	
 	/* Fork and execute */
-	start_time = time(NULL);
+	start_time = nlmon_clock_monotonic_ms();
 	pid = fork();
 	
 	if (pid < 0) {
@@ -162,7 +239,7 @@ static bool execute_script_action(const struct alert_action *action,
 		}
 		
 		/* Check timeout */
-		if ((time(NULL) - start_time) * 1000 >= timeout_ms) {
+		if (nlmon_clock_monotonic_ms() - start_time >= (uint64_t)timeout_ms) {
 			kill(pid, SIGKILL);
 			waitpid(pid, &status, 0);
 			for (int i = 0; envp[i]; i++)
@@ -177,14 +254,15 @@ static bool execute_script_action(const struct alert_action *action,
 
 /* Helper: Execute log action */
 static bool execute_log_action(const struct alert_action *action,
-                               struct nlmon_event *event,
+                               const struct alert_digest *digest,
                                const char *alert_name,
                                enum alert_severity severity)
 {
 	FILE *fp;
 	const char *mode = action->params.log.append ? "a" : "w";
 	const char *severity_str;
-	time_t now = time(NULL);
+	time_t now = nlmon_clock_seconds();
+	struct tm tm_buf;
 	char time_buf[64];
 	
 	switch (severity) {
@@ -208,37 +286,30 @@ static bool execute_log_action(const struct alert_action *action,
 	if (!fp)
 		return false;
 	
-	strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S",
-	         localtime(&now));
+	/* Actions of different events may run at once */
+	localtime_r(&now, &tm_buf);
+	strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", &tm_buf);
 	
-	fprintf(fp, "[%s] [%s] Alert '%s' triggered by event seq=%lu type=%u interface=%s\n",
-	        time_buf, severity_str, alert_name, event->sequence,
-	        event->message_type, event->interface);
+	fprintf(fp, "[%s] [%s] Alert '%s' triggered by event seq=%lu type=%u interface=%.*s",
+	        time_buf, severity_str, alert_name, digest->sequence,
+	        digest->message_type, (int)sizeof(digest->interface), digest->interface);
+	if (digest->count > 1)
+		fprintf(fp, " (%u occurrences)", digest->count);
+	fputc('\n', fp);
 	
 	fclose(fp);
 	return true;
 }
 
-/* Helper: Webhook response callback */
-static size_t webhook_write_callback(void *contents, size_t size, size_t nmemb,
-                                     void *userp)
-{
-	/* Discard response data */
-	return size * nmemb;
-}
-
 /* Helper: Execute webhook action */
-static bool execute_webhook_action(const struct alert_action *action,
-                                   struct nlmon_event *event,
+static bool execute_webhook_action(struct webhook_sender *webhooks,
+                                   const struct alert_action *action,
+                                   const struct alert_digest *digest,
                                    const char *alert_name,
                                    enum alert_severity severity)
 {
-	CURL *curl;
-	CURLcode res;
 	char json_payload[2048];
-	struct curl_slist *headers = NULL;
 	const char *severity_str;
-	bool success = false;
 	
 	switch (severity) {
 	case ALERT_SEVERITY_INFO:
@@ -263,58 +334,374 @@ static bool execute_webhook_action(const struct alert_action *action,
 	         "\"alert_name\":\"%s\","
 	         "\"severity\":\"%s\","
 	         "\"timestamp\":%lu,"
+	         "\"count\":%u,"
+	         "\"first_timestamp\":%lu,"
 	         "\"event\":{"
 	         "\"sequence\":%lu,"
 	         "\"type\":%u,"
 	         "\"message_type\":%u,"
-	         "\"interface\":\"%s\""
+	         "\"interface\":\"%.*s\""
 	         "}"
 	         "}",
-	         alert_name, severity_str, (unsigned long)time(NULL),
-	         event->sequence, event->event_type, event->message_type,
-	         event->interface);
-	
-	curl = curl_easy_init();
-	if (!curl)
-		return false;
-	
-	headers = curl_slist_append(headers, "Content-Type: application/json");
-	
-	curl_easy_setopt(curl, CURLOPT_URL, action->params.webhook.url);
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json_payload);
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, webhook_write_callback);
-	curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS,
-	                 action->params.webhook.timeout_ms > 0 ?
-	                 action->params.webhook.timeout_ms : 10000);
-	
-	res = curl_easy_perform(curl);
-	success = (res == CURLE_OK);
-	
-	curl_slist_free_all(headers);
-	curl_easy_cleanup(curl);
-	
-	return success;
+	         alert_name, severity_str, (unsigned long)nlmon_clock_seconds(),
+	         digest->count, digest->first_timestamp,
+	         digest->sequence, digest->event_type, digest->message_type,
+	         (int)sizeof(digest->interface), digest->interface);
+	
+	/* Delivered by the sender's thread, the trigger path never waits */
+	return webhook_sender_submit(webhooks, action->params.webhook.url, json_payload,
+	                             action->params.webhook.timeout_ms);
 }
 
 /* Helper: Execute alert action */
-static bool execute_alert_action(const struct alert_action *action,
-                                struct nlmon_event *event,
-                                const char *alert_name,
-                                enum alert_severity severity)
+static bool execute_alert_action(struct webhook_sender *webhooks,
+                                 const struct alert_action *action,
+                                 const struct alert_digest *digest,
+                                 const char *alert_name,
+                                 enum alert_severity severity)
 {
 	switch (action->type) {
 	case ALERT_ACTION_EXEC:
-		return execute_script_action(action, event, alert_name);
+		return execute_script_action(action, digest, alert_name);
 	case ALERT_ACTION_LOG:
-		return execute_log_action(action, event, alert_name, severity);
+		return execute_log_action(action, digest, alert_name, severity);
 	case ALERT_ACTION_WEBHOOK:
-		return execute_webhook_action(action, event, alert_name, severity);
+		return execute_webhook_action(webhooks, action, digest, alert_name, severity);
 	default:
 		return false;
 	}
 }
 
+/* FNV-1a */
+static uint64_t interface_hash(const char *name)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	
+	for (size_t i = 0; i < 16 && name[i]; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 1099511628211ULL;
+	}
+	
+	return hash;
+}
+
+/* First indexed field == constant of the top level conjunction, which must hold */
+static const struct filter_node *find_key(const struct filter_node *ast)
+{
+	const struct filter_node *key;
+	
+	if (ast->type == FILTER_NODE_AND) {
+		key = find_key(ast->data.binary.left);
+		return key ? key : find_key(ast->data.binary.right);
+	}
+	
+	if (ast->type != FILTER_NODE_EQ || ast->data.binary.left->type != FILTER_NODE_FIELD)
+		return NULL;
+	
+	/* Constants of the other type never compare equal, such rules stay unkeyed */
+	switch (ast->data.binary.left->data.field.field) {
+	case FILTER_FIELD_EVENT_TYPE:
+	case FILTER_FIELD_MESSAGE_TYPE:
+		return ast->data.binary.right->type == FILTER_NODE_NUMBER ? ast : NULL;
+	case FILTER_FIELD_INTERFACE:
+		return ast->data.binary.right->type == FILTER_NODE_STRING ? ast : NULL;
+	default:
+		return NULL;
+	}
+}
+
+/* Set the index key of entry from its parsed condition */
+static void rule_key(struct alert_rule_entry *entry, const struct filter_node *ast)
+{
+	const struct filter_node *key = find_key(ast);
+	const struct filter_node *constant;
+	
+	entry->keyed = key != NULL;
+	if (!key)
+		return;
+	
+	constant = key->data.binary.right;
+	entry->key_field = key->data.binary.left->data.field.field;
+	if (constant->type == FILTER_NODE_STRING)
+		entry->key_value = interface_hash(constant->data.string.value);
+	else
+		entry->key_value = (uint64_t)constant->data.number.value;
+}
+
+static int key_cmp(const struct rule_key *a, const struct rule_key *b)
+{
+	if (a->field != b->field)
+		return a->field < b->field ? -1 : 1;
+	if (a->value != b->value)
+		return a->value < b->value ? -1 : 1;
+	return 0;
+}
+
+static int key_sort_cmp(const void *a, const void *b)
+{
+	int cmp = key_cmp(a, b);
+	
+	if (cmp != 0)
+		return cmp;
+	return ((const struct rule_key *)a)->rule < ((const struct rule_key *)b)->rule ? -1 : 1;
+}
+
+static void snapshot_free(struct rule_snapshot *snap)
+{
+	if (!snap)
+		return;
+	
+	free(snap->unkeyed);
+	free(snap->keys);
+	free(snap);
+}
+
+static struct rule_snapshot *snapshot_create(struct alert_manager *am)
+{
+	struct rule_snapshot *snap;
+	
+	snap = calloc(1, sizeof(*snap));
+	if (!snap)
+		return NULL;
+	
+	snap->unkeyed = calloc(am->max_rules, sizeof(*snap->unkeyed));
+	snap->keys = calloc(am->max_rules, sizeof(*snap->keys));
+	if (!snap->unkeyed || !snap->keys) {
+		snapshot_free(snap);
+		return NULL;
+	}
+	
+	for (size_t i = 0; i < am->max_rules; i++) {
+		struct alert_rule_entry *entry = &am->rules[i];
+		
+		if (!entry->in_use || !entry->rule.enabled)
+			continue;
+		
+		if (entry->keyed) {
+			struct rule_key *key = &snap->keys[snap->key_count++];
+			
+			key->field = entry->key_field;
+			key->value = entry->key_value;
+			key->rule = (uint32_t)i;
+		} else {
+			snap->unkeyed[snap->unkeyed_count++] = (uint32_t)i;
+		}
+	}
+	
+	qsort(snap->keys, snap->key_count, sizeof(*snap->keys), key_sort_cmp);
+	return snap;
+}
+
+/* Enter a read side section, returns the counter to leave it through */
+static unsigned read_lock(struct alert_manager *am)
+{
+	unsigned idx = atomic_load(&am->reader_epoch) & 1;
+	
+	atomic_fetch_add(&am->readers[idx], 1);
+	return idx;
+}
+
+static void read_unlock(struct alert_manager *am, unsigned idx)
+{
+	atomic_fetch_sub(&am->readers[idx], 1);
+}
+
+/* Wait until no section can still see a replaced snapshot, lock held */
+static void synchronize(struct alert_manager *am)
+{
+	for (int flip = 0; flip < 2; flip++) {
+		unsigned idx = atomic_fetch_add(&am->reader_epoch, 1) & 1;
+		
+		while (atomic_load(&am->readers[idx]) != 0)
+			sched_yield();
+	}
+}
+
+/* Make the rules visible to evaluation, lock held */
+static bool publish(struct alert_manager *am)
+{
+	struct rule_snapshot *snap, *old;
+	
+	snap = snapshot_create(am);
+	if (!snap)
+		return false;
+	
+	old = atomic_exchange(&am->snapshot, snap);
+	synchronize(am);
+	snapshot_free(old);
+	return true;
+}
+
+/* Release what add_rule set up for entry, no evaluation may still see it */
+static void entry_release(struct alert_rule_entry *entry)
+{
+	filter_bytecode_free(entry->filter);
+	free(entry->trigger_times);
+	free(entry->dedup);
+	pthread_mutex_destroy(&entry->lock);
+	entry->filter = NULL;
+	entry->trigger_times = NULL;
+	entry->dedup = NULL;
+	entry->in_use = false;
+}
+
+/* Digest of the single trigger event */
+static void digest_init(struct alert_digest *digest, const struct nlmon_event *event)
+{
+	digest->timestamp = event->timestamp;
+	digest->sequence = event->sequence;
+	digest->event_type = event->event_type;
+	digest->message_type = event->message_type;
+	memcpy(digest->interface, event->interface, sizeof(digest->interface));
+	digest->first_timestamp = event->timestamp;
+	digest->count = 1;
+	digest->due = 0;
+}
+
+/* Add the triggers of src to dst, which becomes due at due if empty */
+static void digest_merge(struct alert_digest *dst, const struct alert_digest *src, time_t due)
+{
+	uint64_t first_timestamp;
+	
+	if (dst->count == 0) {
+		*dst = *src;
+		dst->due = due;
+		return;
+	}
+	
+	first_timestamp = dst->first_timestamp < src->first_timestamp ?
+	                  dst->first_timestamp : src->first_timestamp;
+	if (src->sequence >= dst->sequence) {
+		dst->timestamp = src->timestamp;
+		dst->sequence = src->sequence;
+		dst->event_type = src->event_type;
+		dst->message_type = src->message_type;
+		memcpy(dst->interface, src->interface, sizeof(dst->interface));
+	}
+	dst->first_timestamp = first_timestamp;
+	dst->count = dst->count > UINT32_MAX - src->count ? UINT32_MAX : dst->count + src->count;
+}
+
+/* Whether to run the action for digest now, else it joins the batch; lock held */
+static bool digest_queue(struct alert_rule_entry *entry, const struct alert_digest *digest,
+                         time_t now)
+{
+	uint32_t interval = entry->rule.action.flush_interval_s;
+	
+	if (interval == 0)
+		return true;
+	
+	digest_merge(&entry->batch, digest, now + interval);
+	return false;
+}
+
+/* Hash of the event fields telling duplicates of entry apart */
+static uint64_t dedup_key(const struct alert_rule_entry *entry, const struct nlmon_event *event)
+{
+	uint32_t fields = entry->rule.dedup_fields;
+	uint64_t key = 14695981039346656037ULL;
+	
+	if (fields & ALERT_DEDUP_INTERFACE)
+		key ^= interface_hash(event->interface);
+	if (fields & ALERT_DEDUP_MESSAGE_TYPE)
+		key = (key ^ event->message_type) * 1099511628211ULL;
+	if (fields & ALERT_DEDUP_EVENT_TYPE)
+		key = (key ^ event->event_type) * 1099511628211ULL;
+	return key;
+}
+
+/* Slot of key, or the one whose window ended first to reuse for it; lock held */
+static struct dedup_slot *dedup_slot(struct alert_rule_entry *entry, uint64_t key)
+{
+	struct dedup_slot *victim = &entry->dedup[0];
+	
+	for (size_t i = 0; i < ALERT_DEDUP_KEYS; i++) {
+		struct dedup_slot *slot = &entry->dedup[i];
+		
+		if (slot->window_end != 0 && slot->key == key)
+			return slot;
+		if (slot->window_end < victim->window_end)
+			victim = slot;
+	}
+	
+	return victim;
+}
+
+/* Take one digest of entry to run the action for, lock held */
+static bool digest_take(struct alert_rule_entry *entry, time_t now, bool force,
+                        struct alert_digest *digest)
+{
+	for (size_t i = 0; entry->dedup && i < ALERT_DEDUP_KEYS; i++) {
+		struct alert_digest *pending = &entry->dedup[i].pending;
+		
+		if (pending->count == 0 || (!force && now < pending->due))
+			continue;
+		
+		if (digest_queue(entry, pending, now)) {
+			*digest = *pending;
+			pending->count = 0;
+			return true;
+		}
+		pending->count = 0;
+	}
+	
+	if (entry->batch.count > 0 && (force || now >= entry->batch.due)) {
+		*digest = entry->batch;
+		entry->batch.count = 0;
+		return true;
+	}
+	
+	return false;
+}
+
+/* Run the action of entry for digest */
+static void send_digest(struct alert_manager *am, struct alert_rule_entry *entry,
+                        const struct alert_digest *digest)
+{
+	bool action_success = execute_alert_action(am->webhooks, &entry->rule.action,
+	                                           digest, entry->rule.name,
+	                                           entry->rule.severity);
+	
+	NLMON_PROBE3(alert_send, entry->id, digest->count, action_success);
+	
+	pthread_mutex_lock(&entry->lock);
+	if (action_success)
+		entry->executed_count++;
+	else
+		entry->failed_count++;
+	pthread_mutex_unlock(&entry->lock);
+	
+	pthread_mutex_lock(&am->stats_mutex);
+	if (action_success)
+		am->stats.total_executed++;
+	else
+		am->stats.total_failed++;
+	if (digest->count > 1)
+		am->stats.total_coalesced += digest->count;
+	pthread_mutex_unlock(&am->stats_mutex);
+}
+
+/* Send the digests of entry that are due, or all if force */
+static void flush_rule(struct alert_manager *am, struct alert_rule_entry *entry,
+                       time_t now, bool force)
+{
+	struct alert_digest digest;
+	bool due;
+	
+	if (!entry->dedup && entry->rule.action.flush_interval_s == 0)
+		return;
+	
+	for (;;) {
+		pthread_mutex_lock(&entry->lock);
+		due = digest_take(entry, now, force, &digest);
+		pthread_mutex_unlock(&entry->lock);
+		
+		if (!due)
+			break;
+		send_digest(am, entry, &digest);
+	}
+}
+
 struct alert_manager *alert_manager_create(size_t max_rules, size_t max_history)
 {
 	struct alert_manager *am;
@@ -355,6 +742,21 @@ struct alert_manager *alert_manager_create(size_t max_rules, size_t max_history)
 		return NULL;
 	}
 	
+	atomic_init(&am->readers[0], 0);
+	atomic_init(&am->readers[1], 0);
+	atomic_init(&am->reader_epoch, 0);
+	atomic_init(&am->last_flush, 0);
+	atomic_init(&am->snapshot, snapshot_create(am));
+	if (!atomic_load(&am->snapshot)) {
+		pthread_mutex_destroy(&am->rules_mutex);
+		pthread_mutex_destroy(&am->history_mutex);
+		pthread_mutex_destroy(&am->stats_mutex);
+		free(am->history);
+		free(am->rules);
+		free(am);
+		return NULL;
+	}
+	
 	/* Initialize libcurl */
 	curl_global_init(CURL_GLOBAL_DEFAULT);
 	
@@ -368,16 +770,18 @@ void alert_manager_destroy(struct alert_manager *am)
 	if (!am)
 		return;
 	
-	/* Cleanup rules */
+	/* Cleanup rules, sending what they still have pending */
 	for (i = 0; i < am->max_rules; i++) {
 		if (am->rules[i].in_use) {
-			if (am->rules[i].filter)
-				filter_bytecode_free(am->rules[i].filter);
-			if (am->rules[i].trigger_times)
-				free(am->rules[i].trigger_times);
+			flush_rule(am, &am->rules[i], nlmon_clock_seconds(), true);
+			entry_release(&am->rules[i]);
 		}
 	}
 	
+	/* Deliver the payloads of the digests just sent */
+	webhook_sender_destroy(am->webhooks);
+	
+	snapshot_free(atomic_load(&am->snapshot));
 	free(am->rules);
 	free(am->history);
 	
@@ -418,28 +822,27 @@ int alert_manager_add_rule(struct alert_manager *am, const struct alert_rule *ru
 		return -1;
 	}
 	
-	/* Initialize entry */
+	/* Initialize entry, no snapshot refers to a free slot */
 	memset(entry, 0, sizeof(*entry));
 	id = am->next_rule_id++;
 	entry->id = id;
 	entry->rule = *rule;
-	entry->in_use = true;
 	
 	/* Compile filter condition */
 	struct filter_expr *expr = filter_parse(rule->condition);
 	if (!expr || !expr->valid) {
 		if (expr)
 			filter_expr_free(expr);
-		entry->in_use = false;
 		pthread_mutex_unlock(&am->rules_mutex);
 		return -1;
 	}
 	
-	entry->filter = filter_compile(expr);
+	entry->filter = filter_cache_get_expr(expr);
+	if (entry->filter)
+		rule_key(entry, expr->ast);
 	filter_expr_free(expr);
 	
 	if (!entry->filter) {
-		entry->in_use = false;
 		pthread_mutex_unlock(&am->rules_mutex);
 		return -1;
 	}
@@ -449,12 +852,48 @@ int alert_manager_add_rule(struct alert_manager *am, const struct alert_rule *ru
 		entry->trigger_times = calloc(rule->rate_limit_count, sizeof(time_t));
 		if (!entry->trigger_times) {
 			filter_bytecode_free(entry->filter);
-			entry->in_use = false;
 			pthread_mutex_unlock(&am->rules_mutex);
 			return -1;
 		}
 	}
 	
+	/* Start webhook delivery, published before any rule may use it */
+	if (rule->action.type == ALERT_ACTION_WEBHOOK && !am->webhooks) {
+		am->webhooks = webhook_sender_create(NULL);
+		if (!am->webhooks) {
+			filter_bytecode_free(entry->filter);
+			free(entry->trigger_times);
+			pthread_mutex_unlock(&am->rules_mutex);
+			return -1;
+		}
+	}
+	
+	/* Initialize dedup keys if needed */
+	if (rule->dedup_window_s > 0) {
+		entry->dedup = calloc(ALERT_DEDUP_KEYS, sizeof(*entry->dedup));
+		if (!entry->dedup) {
+			filter_bytecode_free(entry->filter);
+			free(entry->trigger_times);
+			pthread_mutex_unlock(&am->rules_mutex);
+			return -1;
+		}
+	}
+	
+	if (pthread_mutex_init(&entry->lock, NULL) != 0) {
+		filter_bytecode_free(entry->filter);
+		free(entry->trigger_times);
+		free(entry->dedup);
+		pthread_mutex_unlock(&am->rules_mutex);
+		return -1;
+	}
+	
+	entry->in_use = true;
+	if (!publish(am)) {
+		entry_release(entry);
+		pthread_mutex_unlock(&am->rules_mutex);
+		return -1;
+	}
+	
 	pthread_mutex_unlock(&am->rules_mutex);
 	
 	return id;
@@ -482,13 +921,14 @@ bool alert_manager_remove_rule(struct alert_manager *am, int rule_id)
 		return false;
 	}
 	
-	/* Cleanup */
-	if (entry->filter)
-		filter_bytecode_free(entry->filter);
-	if (entry->trigger_times)
-		free(entry->trigger_times);
-	
+	/* Cleanup once evaluation can no longer reach the rule */
 	entry->in_use = false;
+	if (!publish(am)) {
+		entry->in_use = true;
+		pthread_mutex_unlock(&am->rules_mutex);
+		return false;
+	}
+	entry_release(entry);
 	
 	pthread_mutex_unlock(&am->rules_mutex);
 	
@@ -512,8 +952,13 @@ bool alert_manager_enable_rule(struct alert_manager *am, int rule_id)
 		}
 	}
 	
-	if (entry)
+	if (entry && entry->rule.enabled != true) {
 		entry->rule.enabled = true;
+		if (!publish(am)) {
+			entry->rule.enabled = false;
+			entry = NULL;
+		}
+	}
 	
 	pthread_mutex_unlock(&am->rules_mutex);
 	
@@ -537,128 +982,253 @@ bool alert_manager_disable_rule(struct alert_manager *am, int rule_id)
 		}
 	}
 	
-	if (entry)
+	if (entry && entry->rule.enabled != false) {
 		entry->rule.enabled = false;
+		if (!publish(am)) {
+			entry->rule.enabled = true;
+			entry = NULL;
+		}
+	}
 	
 	pthread_mutex_unlock(&am->rules_mutex);
 	
 	return entry != NULL;
 }
 
-void alert_manager_evaluate(struct alert_manager *am, struct nlmon_event *event)
+/* Trigger entry if event meets its condition */
+static void evaluate_rule(struct alert_manager *am, struct alert_rule_entry *entry,
+                          struct nlmon_event *event, time_t now)
 {
-	size_t i;
-	time_t now;
+	struct alert_digest trigger, runs[2];
+	size_t run_count = 0;
+	bool suppress;
 	
-	if (!am || !event)
+	/* Evaluate condition */
+	if (!filter_eval(entry->filter, event, NULL))
 		return;
 	
-	now = get_current_time();
+	pthread_mutex_lock(&entry->lock);
 	
-	pthread_mutex_lock(&am->rules_mutex);
+	/* Check suppression */
+	if (entry->suppressed && now < entry->suppress_until) {
+		pthread_mutex_unlock(&entry->lock);
+		return;
+	} else if (entry->suppressed && now >= entry->suppress_until) {
+		entry->suppressed = false;
+	}
 	
-	for (i = 0; i < am->max_rules; i++) {
-		struct alert_rule_entry *entry = &am->rules[i];
+	/* Check rate limiting */
+	if (entry->rule.rate_limit_count > 0 && entry->rule.rate_limit_window_s > 0) {
+		time_t window_start = now - entry->rule.rate_limit_window_s;
+		size_t triggers_in_window = 0;
 		
-		if (!entry->in_use || !entry->rule.enabled)
-			continue;
+		/* Count triggers in window */
+		for (size_t j = 0; j < entry->trigger_count; j++) {
+			if (entry->trigger_times[j] >= window_start)
+				triggers_in_window++;
+		}
 		
-		/* Check suppression */
-		if (entry->suppressed && now < entry->suppress_until)
-			continue;
-		else if (entry->suppressed && now >= entry->suppress_until)
-			entry->suppressed = false;
+		if (triggers_in_window >= entry->rule.rate_limit_count) {
+			/* Rate limit exceeded */
+			entry->rate_limited_count++;
+			pthread_mutex_unlock(&entry->lock);
+			pthread_mutex_lock(&am->stats_mutex);
+			am->stats.total_rate_limited++;
+			pthread_mutex_unlock(&am->stats_mutex);
+			return;
+		}
 		
-		/* Evaluate condition */
-		if (!filter_eval(entry->filter, event, NULL))
-			continue;
+		/* Record trigger time */
+		entry->trigger_times[entry->trigger_index] = now;
+		entry->trigger_index = (entry->trigger_index + 1) % entry->rule.rate_limit_count;
+		if (entry->trigger_count < entry->rule.rate_limit_count)
+			entry->trigger_count++;
+	}
+	
+	entry->triggered_count++;
+	
+	/* Apply suppression if configured */
+	suppress = entry->rule.suppress_duration_s > 0;
+	if (suppress) {
+		entry->suppressed = true;
+		entry->suppress_until = now + entry->rule.suppress_duration_s;
+		entry->suppressed_count++;
+	}
+	
+	/* Duplicates within the window of their key wait in its digest */
+	digest_init(&trigger, event);
+	if (entry->dedup) {
+		uint64_t key = dedup_key(entry, event);
+		struct dedup_slot *slot = dedup_slot(entry, key);
 		
-		/* Check rate limiting */
-		if (entry->rule.rate_limit_count > 0 && entry->rule.rate_limit_window_s > 0) {
-			time_t window_start = now - entry->rule.rate_limit_window_s;
-			size_t triggers_in_window = 0;
+		if (slot->key == key && now < slot->window_end) {
+			digest_merge(&slot->pending, &trigger, slot->window_end);
+			trigger.count = 0;
 			
-			/* Count triggers in window */
-			for (size_t j = 0; j < entry->trigger_count; j++) {
-				if (entry->trigger_times[j] >= window_start)
-					triggers_in_window++;
+			if (entry->rule.coalesce_count > 0 &&
+			    slot->pending.count >= entry->rule.coalesce_count) {
+				if (digest_queue(entry, &slot->pending, now))
+					runs[run_count++] = slot->pending;
+				slot->pending.count = 0;
 			}
-			
-			if (triggers_in_window >= entry->rule.rate_limit_count) {
-				/* Rate limit exceeded */
-				entry->rate_limited_count++;
-				pthread_mutex_lock(&am->stats_mutex);
-				am->stats.total_rate_limited++;
-				pthread_mutex_unlock(&am->stats_mutex);
-				continue;
-			}
-			
-			/* Record trigger time */
-			entry->trigger_times[entry->trigger_index] = now;
-			entry->trigger_index = (entry->trigger_index + 1) % entry->rule.rate_limit_count;
-			if (entry->trigger_count < entry->rule.rate_limit_count)
-				entry->trigger_count++;
+		} else {
+			/* The slot's previous key is sent, whether due or evicted */
+			if (slot->pending.count > 0 && digest_queue(entry, &slot->pending, now))
+				runs[run_count++] = slot->pending;
+			slot->key = key;
+			slot->window_end = now + entry->rule.dedup_window_s;
+			slot->pending.count = 0;
 		}
-		
-		entry->triggered_count++;
-		
-		/* Execute action */
-		bool action_success = execute_alert_action(&entry->rule.action, event,
-		                                           entry->rule.name,
-		                                           entry->rule.severity);
-		
-		if (action_success)
-			entry->executed_count++;
-		else
-			entry->failed_count++;
-		
-		/* Update global statistics */
+	}
+	if (trigger.count > 0 && digest_queue(entry, &trigger, now))
+		runs[run_count++] = trigger;
+	
+	pthread_mutex_unlock(&entry->lock);
+	NLMON_PROBE3(alert_fire, entry->id, entry->rule.name, event->sequence);
+	
+	/* Execute actions, other events may trigger the rule meanwhile */
+	for (size_t i = 0; i < run_count; i++)
+		send_digest(am, entry, &runs[i]);
+	
+	/* Update global statistics */
+	pthread_mutex_lock(&am->stats_mutex);
+	am->stats.total_triggered++;
+	pthread_mutex_unlock(&am->stats_mutex);
+	
+	/* Create alert instance */
+	pthread_mutex_lock(&am->history_mutex);
+	
+	struct alert_instance *instance = &am->history[am->history_index];
+	instance->id = am->next_alert_id++;
+	strncpy(instance->rule_name, entry->rule.name, ALERT_MAX_NAME - 1);
+	instance->severity = entry->rule.severity;
+	instance->state = ALERT_STATE_ACTIVE;
+	instance->triggered_at = now;
+	instance->acknowledged_at = 0;
+	instance->resolved_at = 0;
+	instance->event_sequence = event->sequence;
+	snprintf(instance->message, ALERT_MAX_MESSAGE,
+	         "Alert triggered by event type=%u interface=%s",
+	         event->message_type, event->interface);
+	instance->acknowledged_by[0] = '\0';
+	
+	am->history_index = (am->history_index + 1) % am->max_history;
+	if (am->history_count < am->max_history)
+		am->history_count++;
+	
+	am->stats.active_count++;
+	
+	pthread_mutex_unlock(&am->history_mutex);
+	
+	if (suppress) {
 		pthread_mutex_lock(&am->stats_mutex);
-		am->stats.total_triggered++;
-		if (action_success)
-			am->stats.total_executed++;
-		else
-			am->stats.total_failed++;
+		am->stats.total_suppressed++;
 		pthread_mutex_unlock(&am->stats_mutex);
+	}
+}
+
+/* Range of the keys matching probe, empty if none */
+static void key_range(const struct rule_snapshot *snap, const struct rule_key *probe,
+                      size_t *start, size_t *end)
+{
+	size_t lo = 0, hi = snap->key_count;
+	
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
 		
-		/* Create alert instance */
-		pthread_mutex_lock(&am->history_mutex);
-		
-		struct alert_instance *instance = &am->history[am->history_index];
-		instance->id = am->next_alert_id++;
-		strncpy(instance->rule_name, entry->rule.name, ALERT_MAX_NAME - 1);
-		instance->severity = entry->rule.severity;
-		instance->state = ALERT_STATE_ACTIVE;
-		instance->triggered_at = now;
-		instance->acknowledged_at = 0;
-		instance->resolved_at = 0;
-		instance->event_sequence = event->sequence;
-		snprintf(instance->message, ALERT_MAX_MESSAGE,
-		         "Alert triggered by event type=%u interface=%s",
-		         event->message_type, event->interface);
-		instance->acknowledged_by[0] = '\0';
-		
-		am->history_index = (am->history_index + 1) % am->max_history;
-		if (am->history_count < am->max_history)
-			am->history_count++;
+		if (key_cmp(&snap->keys[mid], probe) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	
+	*start = lo;
+	while (lo < snap->key_count && key_cmp(&snap->keys[lo], probe) == 0)
+		lo++;
+	*end = lo;
+}
+
+void alert_manager_evaluate(struct alert_manager *am, struct nlmon_event *event)
+{
+	struct rule_snapshot *snap;
+	struct rule_key probe[3];
+	size_t next[3], end[3], unkeyed = 0;
+	time_t now, last;
+	unsigned idx;
+	
+	if (!am || !event)
+		return;
+	
+	now = nlmon_clock_seconds();
+	
+	/* The interface may still be undecoded */
+	nlmon_event_materialize(event);
+	
+	probe[0].field = FILTER_FIELD_EVENT_TYPE;
+	probe[0].value = (uint64_t)(int64_t)event->event_type;
+	probe[1].field = FILTER_FIELD_MESSAGE_TYPE;
+	probe[1].value = (uint64_t)(int64_t)event->message_type;
+	probe[2].field = FILTER_FIELD_INTERFACE;
+	probe[2].value = interface_hash(event->interface);
+	
+	idx = read_lock(am);
+	snap = atomic_load(&am->snapshot);
+	
+	for (size_t i = 0; i < 3; i++)
+		key_range(snap, &probe[i], &next[i], &end[i]);
+	
+	/* Candidates of each list in slot order, merged to keep rule order */
+	for (;;) {
+		uint32_t rule = UINT32_MAX;
+		size_t from = 3;
 		
-		am->stats.active_count++;
+		if (unkeyed < snap->unkeyed_count)
+			rule = snap->unkeyed[unkeyed];
+		for (size_t i = 0; i < 3; i++) {
+			if (next[i] < end[i] && snap->keys[next[i]].rule < rule) {
+				rule = snap->keys[next[i]].rule;
+				from = i;
+			}
+		}
 		
-		pthread_mutex_unlock(&am->history_mutex);
+		if (rule == UINT32_MAX)
+			break;
+		if (from == 3)
+			unkeyed++;
+		else
+			next[from]++;
 		
-		/* Apply suppression if configured */
-		if (entry->rule.suppress_duration_s > 0) {
-			entry->suppressed = true;
-			entry->suppress_until = now + entry->rule.suppress_duration_s;
-			entry->suppressed_count++;
-			
-			pthread_mutex_lock(&am->stats_mutex);
-			am->stats.total_suppressed++;
-			pthread_mutex_unlock(&am->stats_mutex);
-		}
+		evaluate_rule(am, &am->rules[rule], event, now);
 	}
 	
-	pthread_mutex_unlock(&am->rules_mutex);
+	read_unlock(am, idx);
+	
+	/* Digests that came due meanwhile, one evaluation per second sends them */
+	last = atomic_load(&am->last_flush);
+	if (last != now && atomic_compare_exchange_strong(&am->last_flush, &last, now))
+		alert_manager_flush(am, false);
+}
+
+void alert_manager_flush(struct alert_manager *am, bool force)
+{
+	struct rule_snapshot *snap;
+	time_t now;
+	unsigned idx;
+	
+	if (!am)
+		return;
+	
+	now = nlmon_clock_seconds();
+	
+	idx = read_lock(am);
+	snap = atomic_load(&am->snapshot);
+	
+	for (size_t i = 0; i < snap->unkeyed_count; i++)
+		flush_rule(am, &am->rules[snap->unkeyed[i]], now, force);
+	for (size_t i = 0; i < snap->key_count; i++)
+		flush_rule(am, &am->rules[snap->keys[i].rule], now, force);
+	
+	read_unlock(am, idx);
 }
 
 bool alert_manager_acknowledge(struct alert_manager *am, uint64_t alert_id,
@@ -677,7 +1247,7 @@ bool alert_manager_acknowledge(struct alert_manager *am, uint64_t alert_id,
 		
 		if (instance->id == alert_id && instance->state == ALERT_STATE_ACTIVE) {
 			instance->state = ALERT_STATE_ACKNOWLEDGED;
-			instance->acknowledged_at = get_current_time();
+			instance->acknowledged_at = nlmon_clock_seconds();
 			strncpy(instance->acknowledged_by, acknowledged_by, 63);
 			instance->acknowledged_by[63] = '\0';
 			
@@ -715,7 +1285,7 @@ bool alert_manager_resolve(struct alert_manager *am, uint64_t alert_id)
 		     instance->state == ALERT_STATE_ACKNOWLEDGED)) {
 			enum alert_state old_state = instance->state;
 			instance->state = ALERT_STATE_INACTIVE;
-			instance->resolved_at = get_current_time();
+			instance->resolved_at = nlmon_clock_seconds();
 			
 			pthread_mutex_lock(&am->stats_mutex);
 			if (old_state == ALERT_STATE_ACTIVE && am->stats.active_count > 0)
@@ -793,6 +1363,22 @@ bool alert_manager_get_stats(struct alert_manager *am, struct alert_stats *stats
 	return true;
 }
 
+size_t alert_manager_get_webhook_stats(struct alert_manager *am,
+                                       struct webhook_endpoint_stats *stats,
+                                       size_t max_stats)
+{
+	struct webhook_sender *webhooks;
+	
+	if (!am || !stats)
+		return 0;
+	
+	pthread_mutex_lock(&am->rules_mutex);
+	webhooks = am->webhooks;
+	pthread_mutex_unlock(&am->rules_mutex);
+	
+	return webhook_sender_get_stats(webhooks, stats, max_stats);
+}
+
 void alert_manager_reset_stats(struct alert_manager *am)
 {
 	if (!am)
@@ -870,8 +1456,10 @@ bool alert_manager_suppress(struct alert_manager *am, int rule_id,
 	}
 	
 	if (entry) {
+		pthread_mutex_lock(&entry->lock);
 		entry->suppressed = true;
-		entry->suppress_until = get_current_time() + duration_s;
+		entry->suppress_until = nlmon_clock_seconds() + duration_s;
+		pthread_mutex_unlock(&entry->lock);
 	}
 	
 	pthread_mutex_unlock(&am->rules_mutex);
@@ -897,8 +1485,10 @@ bool alert_manager_unsuppress(struct alert_manager *am, int rule_id)
 	}
 	
 	if (entry) {
+		pthread_mutex_lock(&entry->lock);
 		entry->suppressed = false;
 		entry->suppress_until = 0;
+		pthread_mutex_unlock(&entry->lock);
 	}
 	
 	pthread_mutex_unlock(&am->rules_mutex);
@@ -2,6 +2,13 @@
  *
  * Implements baseline statistics collection and anomaly detection using
  * standard deviation-based scoring to identify unusual network behavior.
+ *
+ * Baselines are streaming: an event only counts towards its interval,
+ * and a finished interval's rate updates exponentially weighted moments
+ * and a P-square quantile estimate (Jain and Chlamtac) in O(1), so no
+ * history of values is kept. Baselines live in a set-associative table
+ * keyed by event type and interface name, the empty name being the
+ * baseline over all interfaces.
  */
 
 #include "correlation_engine.h"
@@ -12,29 +19,52 @@
 #include <math.h>
 #include <pthread.h>
 
-#define MAX_EVENT_TYPES 256
+#define BASELINE_WAYS 8
+#define BASELINE_SETS (ANOMALY_MAX_BASELINES / BASELINE_WAYS)
+#define HOURS_PER_DAY 24
+#define BASELINE_QUANTILE 0.99
+
+/* Empty intervals filled in after a pause, longer pauses count as this many */
+#define MAX_IDLE_INTERVALS 64
+
+/* Exponentially weighted mean and variance of interval rates */
+struct ewma_stats {
+	double mean;
+	double variance;
+	uint64_t samples;
+};
+
+/* P-square estimate of one quantile from five markers */
+struct p2_quantile {
+	double height[5];
+	double desired[5];
+	int position[5];
+	uint64_t samples;
+};
 
 /* Baseline statistics for an event type */
 struct baseline_stats {
 	uint32_t event_type;
-	double *values;
-	size_t value_count;
-	size_t value_capacity;
-	double mean;
-	double stddev;
-	double sum;
-	double sum_squares;
-	time_t last_update;
-	bool initialized;
+	char interface[16];
+	bool used;
+	uint64_t last_used;
+	time_t interval_start;
+	uint64_t interval_count;   /* Events in the current interval */
+	struct ewma_stats overall;
+	struct ewma_stats hourly[HOURS_PER_DAY];
+	struct p2_quantile p99;
+};
+
+struct baseline_set {
+	struct baseline_stats ways[BASELINE_WAYS];
 };
 
 /* Anomaly detector structure */
 struct anomaly_detector {
-	struct baseline_stats baselines[MAX_EVENT_TYPES];
-	size_t baseline_count;
+	struct baseline_set sets[BASELINE_SETS];
+	uint64_t use_clock;
 	time_t baseline_window_sec;
 	double threshold;
-	struct time_window *window;
 	pthread_mutex_t lock;
 };
 
@@ -52,16 +82,8 @@ struct anomaly_detector *anomaly_detector_create(time_t baseline_window_sec,
 
 	detector->baseline_window_sec = baseline_window_sec;
 	detector->threshold = threshold;
-	detector->baseline_count = 0;
-
-	detector->window = time_window_create(baseline_window_sec, 10000);
-	if (!detector->window) {
-		free(detector);
-		return NULL;
-	}
 
 	if (pthread_mutex_init(&detector->lock, NULL) != 0) {
-		time_window_destroy(detector->window);
 		free(detector);
 		return NULL;
 	}
@@ -71,74 +93,187 @@ struct anomaly_detector *anomaly_detector_create(time_t baseline_window_sec,
 
 void anomaly_detector_destroy(struct anomaly_detector *detector)
 {
-	size_t i;
-
 	if (!detector)
 		return;
 
-	/* Free baseline value arrays */
-	for (i = 0; i < detector->baseline_count; i++) {
-		free(detector->baselines[i].values);
-	}
-
-	time_window_destroy(detector->window);
 	pthread_mutex_destroy(&detector->lock);
 	free(detector);
 }
 
-/* Find or create baseline for event type */
-static struct baseline_stats *find_baseline(struct anomaly_detector *detector,
-                                            uint32_t event_type)
+static void ewma_add(struct ewma_stats *stats, double value)
 {
-	size_t i;
+	double alpha, diff, incr;
+
+	/* Plain mean and variance until the average spans enough samples */
+	if (stats->samples < ANOMALY_EWMA_SAMPLES)
+		alpha = 1.0 / (double)(stats->samples + 1);
+	else
+		alpha = 2.0 / (ANOMALY_EWMA_SAMPLES + 1);
+
+	diff = value - stats->mean;
+	incr = alpha * diff;
+	stats->mean += incr;
+	stats->variance = (1.0 - alpha) * (stats->variance + diff * incr);
+	stats->samples++;
+}
 
-	/* Search for existing baseline */
-	for (i = 0; i < detector->baseline_count; i++) {
-		if (detector->baselines[i].event_type == event_type) {
-			return &detector->baselines[i];
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void p2_add(struct p2_quantile *p2, double value, double quantile)
+{
+	const double step[5] = { 0.0, quantile / 2, quantile, (1 + quantile) / 2, 1.0 };
+	int k, i;
+
+	/* The first five values become the markers */
+	if (p2->samples < 5) {
+		p2->height[p2->samples++] = value;
+		if (p2->samples == 5) {
+			qsort(p2->height, 5, sizeof(double), compare_double);
+			for (i = 0; i < 5; i++) {
+				p2->position[i] = i + 1;
+				p2->desired[i] = 1 + 4 * step[i];
+			}
 		}
+		return;
 	}
 
-	/* Create new baseline if space available */
-	if (detector->baseline_count < MAX_EVENT_TYPES) {
-		struct baseline_stats *baseline = &detector->baselines[detector->baseline_count];
-		baseline->event_type = event_type;
-		baseline->value_capacity = 1000;
-		baseline->values = calloc(baseline->value_capacity, sizeof(double));
-		if (!baseline->values)
-			return NULL;
-		baseline->value_count = 0;
-		baseline->mean = 0.0;
-		baseline->stddev = 0.0;
-		baseline->sum = 0.0;
-		baseline->sum_squares = 0.0;
-		baseline->last_update = 0;
-		baseline->initialized = false;
-		detector->baseline_count++;
-		return baseline;
+	if (value < p2->height[0]) {
+		p2->height[0] = value;
+		k = 0;
+	} else if (value >= p2->height[4]) {
+		p2->height[4] = value;
+		k = 3;
+	} else {
+		for (k = 0; k < 3 && value >= p2->height[k + 1]; k++)
+			;
 	}
 
-	return NULL;
+	for (i = k + 1; i < 5; i++)
+		p2->position[i]++;
+	for (i = 0; i < 5; i++)
+		p2->desired[i] += step[i];
+
+	/* Move the middle markers towards their desired positions */
+	for (i = 1; i < 4; i++) {
+		double d = p2->desired[i] - p2->position[i];
+		int below = p2->position[i] - p2->position[i - 1];
+		int above = p2->position[i + 1] - p2->position[i];
+		double h, parabolic;
+		int s;
+
+		if (!((d >= 1 && above > 1) || (d <= -1 && below > 1)))
+			continue;
+
+		s = d > 0 ? 1 : -1;
+		h = p2->height[i];
+		parabolic = h + (double)s / (above + below) *
+		            ((below + s) * (p2->height[i + 1] - h) / above +
+		             (above - s) * (h - p2->height[i - 1]) / below);
+
+		if (p2->height[i - 1] < parabolic && parabolic < p2->height[i + 1])
+			p2->height[i] = parabolic;
+		else
+			p2->height[i] = h + s * (p2->height[i + s] - h) /
+			                (p2->position[i + s] - p2->position[i]);
+		p2->position[i] += s;
+	}
+
+	p2->samples++;
 }
 
-/* Calculate mean and standard deviation */
-static void calculate_statistics(struct baseline_stats *baseline)
+static double p2_value(const struct p2_quantile *p2, double quantile)
 {
-	if (baseline->value_count == 0) {
-		baseline->mean = 0.0;
-		baseline->stddev = 0.0;
-		return;
+	double sorted[5];
+
+	if (p2->samples == 0)
+		return 0.0;
+	if (p2->samples >= 5)
+		return p2->height[2];
+
+	/* Too few values for markers, take the nearest of the sorted ones */
+	memcpy(sorted, p2->height, p2->samples * sizeof(double));
+	qsort(sorted, p2->samples, sizeof(double), compare_double);
+	return sorted[(size_t)(quantile * (double)(p2->samples - 1) + 0.5)];
+}
+
+static size_t hour_of_day(time_t t)
+{
+	return (size_t)((t / 3600) % HOURS_PER_DAY);
+}
+
+/* FNV-1a of the event type and interface name */
+static uint32_t baseline_hash(uint32_t event_type, const char *interface)
+{
+	uint32_t hash = 2166136261u;
+
+	for (size_t i = 0; i < 4; i++) {
+		hash ^= (event_type >> (8 * i)) & 0xff;
+		hash *= 16777619u;
+	}
+	for (size_t i = 0; i < 16 && interface[i]; i++) {
+		hash ^= (unsigned char)interface[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/* Find or create baseline for event type on interface */
+static struct baseline_stats *find_baseline(struct anomaly_detector *detector,
+                                            uint32_t event_type,
+                                            const char *interface)
+{
+	struct baseline_set *set;
+	struct baseline_stats *baseline, *victim;
+	size_t i;
+
+	set = &detector->sets[baseline_hash(event_type, interface) % BASELINE_SETS];
+	victim = &set->ways[0];
+
+	/* Search for existing baseline */
+	for (i = 0; i < BASELINE_WAYS; i++) {
+		baseline = &set->ways[i];
+		if (baseline->used && baseline->event_type == event_type &&
+		    strncmp(baseline->interface, interface, sizeof(baseline->interface)) == 0) {
+			baseline->last_used = ++detector->use_clock;
+			return baseline;
+		}
+		if (victim->used && (!baseline->used || baseline->last_used < victim->last_used))
+			victim = baseline;
 	}
 
-	/* Calculate mean */
-	baseline->mean = baseline->sum / baseline->value_count;
+	/* Replace the baseline used longest ago */
+	memset(victim, 0, sizeof(*victim));
+	victim->used = true;
+	victim->event_type = event_type;
+	strncpy(victim->interface, interface, sizeof(victim->interface) - 1);
+	victim->last_used = ++detector->use_clock;
+	return victim;
+}
 
-	/* Calculate standard deviation */
-	double variance = (baseline->sum_squares / baseline->value_count) -
-	                  (baseline->mean * baseline->mean);
-	baseline->stddev = sqrt(fabs(variance));
+/* Add one interval's rate, the interval starting at t */
+static void add_sample(struct baseline_stats *baseline, double value, time_t t)
+{
+	ewma_add(&baseline->overall, value);
+	ewma_add(&baseline->hourly[hour_of_day(t)], value);
+	p2_add(&baseline->p99, value, BASELINE_QUANTILE);
+}
+
+/* Statistics a rate at t is scored against, NULL while too few samples */
+static struct ewma_stats *scoring_stats(struct baseline_stats *baseline, time_t t)
+{
+	struct ewma_stats *hourly = &baseline->hourly[hour_of_day(t)];
 
-	baseline->initialized = true;
+	if (hourly->samples >= ANOMALY_MIN_SAMPLES)
+		return hourly;
+	if (baseline->overall.samples >= ANOMALY_MIN_SAMPLES)
+		return &baseline->overall;
+	return NULL;
 }
 
 void anomaly_detector_update_baseline(struct anomaly_detector *detector,
@@ -152,56 +287,97 @@ void anomaly_detector_update_baseline(struct anomaly_detector *detector,
 
 	pthread_mutex_lock(&detector->lock);
 
-	baseline = find_baseline(detector, event_type);
-	if (!baseline) {
-		pthread_mutex_unlock(&detector->lock);
-		return;
-	}
-
-	/* Add value to baseline */
-	if (baseline->value_count < baseline->value_capacity) {
-		baseline->values[baseline->value_count] = value;
-		baseline->value_count++;
-		baseline->sum += value;
-		baseline->sum_squares += value * value;
-	} else {
-		/* Remove oldest value and add new one */
-		double old_value = baseline->values[0];
-		memmove(baseline->values, baseline->values + 1,
-		        (baseline->value_capacity - 1) * sizeof(double));
-		baseline->values[baseline->value_capacity - 1] = value;
-		baseline->sum = baseline->sum - old_value + value;
-		baseline->sum_squares = baseline->sum_squares -
-		                        (old_value * old_value) +
-		                        (value * value);
-	}
-
-	/* Recalculate statistics */
-	calculate_statistics(baseline);
+	baseline = find_baseline(detector, event_type, "");
+	add_sample(baseline, value, time(NULL));
 
 	pthread_mutex_unlock(&detector->lock);
 }
 
 /* Calculate anomaly score (number of standard deviations from mean) */
-static double calculate_anomaly_score(struct baseline_stats *baseline,
+static double calculate_anomaly_score(const struct ewma_stats *stats,
                                       double value)
 {
-	if (!baseline->initialized || baseline->stddev == 0.0)
+	double stddev = sqrt(stats->variance);
+
+	if (stddev == 0.0)
 		return 0.0;
 
-	return fabs(value - baseline->mean) / baseline->stddev;
+	return fabs(value - stats->mean) / stddev;
 }
 
-/* Count events of a specific type in time window */
-static size_t count_events_in_window(struct time_window *window,
-                                     uint32_t event_type,
-                                     time_t window_sec)
+/* Report value if it is an anomaly; above the mean only if high, or below only if low */
+static size_t check_rate(struct anomaly_detector *detector,
+                         struct baseline_stats *baseline,
+                         double value, bool high, time_t interval_start,
+                         time_t detected_at, struct anomaly_result *result)
 {
-	struct nlmon_event *events[10000];
-	size_t count;
+	struct ewma_stats *stats = scoring_stats(baseline, interval_start);
+	double score;
+
+	if (!stats || (value > stats->mean) != high)
+		return 0;
 
-	count = time_window_query(window, event_type, NULL, events, 10000);
-	return count;
+	score = calculate_anomaly_score(stats, value);
+	if (score < detector->threshold)
+		return 0;
+
+	snprintf(result->anomaly_type, sizeof(result->anomaly_type),
+	         "rate_anomaly_%u", baseline->event_type);
+	result->event_type = baseline->event_type;
+	memcpy(result->interface, baseline->interface, sizeof(result->interface));
+	result->score = score;
+	result->baseline_mean = stats->mean;
+	result->baseline_stddev = sqrt(stats->variance);
+	result->baseline_p99 = p2_value(&baseline->p99, BASELINE_QUANTILE);
+	result->current_value = value;
+	result->detected_at = detected_at;
+	return 1;
+}
+
+/* Count an event at current_time towards baseline */
+static size_t baseline_process(struct anomaly_detector *detector,
+                               struct baseline_stats *baseline,
+                               time_t current_time,
+                               struct anomaly_result *results,
+                               size_t max_results)
+{
+	time_t window = detector->baseline_window_sec;
+	size_t found = 0;
+	double value;
+
+	if (!baseline->interval_start && !baseline->interval_count)
+		baseline->interval_start = current_time - current_time % window;
+
+	/* Finish the interval, then fill in the empty ones since */
+	if (current_time >= baseline->interval_start + window) {
+		time_t intervals = (current_time - baseline->interval_start) / window;
+		time_t idle = intervals - 1;
+
+		value = (double)baseline->interval_count / window;
+		found += check_rate(detector, baseline, value, false,
+		                    baseline->interval_start, current_time,
+		                    &results[found]);
+		add_sample(baseline, value, baseline->interval_start);
+
+		if (idle > MAX_IDLE_INTERVALS)
+			idle = MAX_IDLE_INTERVALS;
+		for (time_t i = intervals - idle; i < intervals; i++)
+			add_sample(baseline, 0.0, baseline->interval_start + i * window);
+
+		baseline->interval_start += intervals * window;
+		baseline->interval_count = 0;
+	}
+
+	baseline->interval_count++;
+
+	/* The interval's rate only grows, report it once it is too high */
+	value = (double)baseline->interval_count / window;
+	if (found < max_results)
+		found += check_rate(detector, baseline, value, true,
+		                    baseline->interval_start, current_time,
+		                    &results[found]);
+
+	return found;
 }
 
 size_t anomaly_detector_process(struct anomaly_detector *detector,
@@ -211,57 +387,22 @@ size_t anomaly_detector_process(struct anomaly_detector *detector,
 {
 	struct baseline_stats *baseline;
 	size_t found = 0;
-	time_t current_time;
-	double current_value;
-	double score;
 
 	if (!detector || !event || !results || max_results == 0)
 		return 0;
 
-	current_time = event->timestamp;
-
 	pthread_mutex_lock(&detector->lock);
 
-	/* Add event to window */
-	time_window_add(detector->window, event);
-	time_window_expire(detector->window, current_time);
-
-	/* Find baseline for this event type */
-	baseline = find_baseline(detector, event->event_type);
-	if (!baseline) {
-		pthread_mutex_unlock(&detector->lock);
-		return 0;
-	}
-
-	/* Calculate current event rate */
-	size_t event_count = count_events_in_window(detector->window,
-	                                            event->event_type,
-	                                            detector->baseline_window_sec);
-	current_value = (double)event_count / detector->baseline_window_sec;
+	/* Baseline over all interfaces */
+	baseline = find_baseline(detector, event->event_type, "");
+	found += baseline_process(detector, baseline, event->timestamp,
+	                          results, max_results);
 
-	/* Update baseline if enough time has passed */
-	if (current_time - baseline->last_update >= 60) {
-		anomaly_detector_update_baseline(detector, event->event_type, current_value);
-		baseline->last_update = current_time;
-	}
-
-	/* Calculate anomaly score */
-	score = calculate_anomaly_score(baseline, current_value);
-
-	/* Check if anomaly detected */
-	if (baseline->initialized && score >= detector->threshold) {
-		if (found < max_results) {
-			snprintf(results[found].anomaly_type,
-			        sizeof(results[found].anomaly_type),
-			        "rate_anomaly_%u", event->event_type);
-			results[found].event_type = event->event_type;
-			results[found].score = score;
-			results[found].baseline_mean = baseline->mean;
-			results[found].baseline_stddev = baseline->stddev;
-			results[found].current_value = current_value;
-			results[found].detected_at = current_time;
-			found++;
-		}
+	/* Baseline of the event's interface */
+	if (event->interface[0] && found < max_results) {
+		baseline = find_baseline(detector, event->event_type, event->interface);
+		found += baseline_process(detector, baseline, event->timestamp,
+		                          results + found, max_results - found);
 	}
 
 	pthread_mutex_unlock(&detector->lock);
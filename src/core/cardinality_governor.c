@@ -0,0 +1,284 @@
+/* cardinality_governor.c - Bounds on the label sets of metrics
+ *
+ * Names with limits are kept in a small array searched linearly, there
+ * are a few of them and they are only looked at when a series is created
+ * and per name when reading.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "cardinality_governor.h"
+
+#define NAME_MAX_LEN 128
+
+/* A metric name with limits */
+struct governed_name {
+	char name[NAME_MAX_LEN];
+	struct cardinality_limits limits;
+	uint64_t series;
+	uint64_t rejected;
+	uint64_t folded;
+	uint64_t expired;
+};
+
+/* Cardinality governor */
+struct cardinality_governor {
+	pthread_mutex_t lock;
+	struct governed_name *names;
+	size_t count;
+	size_t capacity;
+	struct cardinality_limits defaults;
+	bool active;
+};
+
+static bool limits_set(const struct cardinality_limits *limits)
+{
+	return limits->max_series || limits->top_k || limits->stale_ms;
+}
+
+static struct governed_name *find_name(struct cardinality_governor *gov, const char *name)
+{
+	for (size_t i = 0; i < gov->count; i++) {
+		if (strcmp(gov->names[i].name, name) == 0)
+			return &gov->names[i];
+	}
+	return NULL;
+}
+
+static struct governed_name *add_name(struct cardinality_governor *gov, const char *name,
+                                      const struct cardinality_limits *limits)
+{
+	struct governed_name *entry;
+	
+	if (strlen(name) >= NAME_MAX_LEN)
+		return NULL;
+	
+	if (gov->count == gov->capacity) {
+		size_t capacity = gov->capacity ? gov->capacity * 2 : 8;
+		struct governed_name *names = realloc(gov->names, capacity * sizeof(*names));
+	
+		if (!names)
+			return NULL;
+		gov->names = names;
+		gov->capacity = capacity;
+	}
+	
+	entry = &gov->names[gov->count++];
+	memset(entry, 0, sizeof(*entry));
+	strcpy(entry->name, name);
+	entry->limits = *limits;
+	return entry;
+}
+
+/* Entry of a name with limits, taking on the defaults, NULL if none */
+static struct governed_name *governed(struct cardinality_governor *gov, const char *name)
+{
+	struct governed_name *entry = find_name(gov, name);
+	
+	if (!entry && limits_set(&gov->defaults))
+		entry = add_name(gov, name, &gov->defaults);
+	if (entry && !limits_set(&entry->limits))
+		return NULL;
+	return entry;
+}
+
+static void update_active(struct cardinality_governor *gov)
+{
+	bool active = limits_set(&gov->defaults);
+	
+	for (size_t i = 0; !active && i < gov->count; i++)
+		active = limits_set(&gov->names[i].limits);
+	__atomic_store_n(&gov->active, active, __ATOMIC_RELEASE);
+}
+
+struct cardinality_governor *cardinality_governor_create(void)
+{
+	struct cardinality_governor *gov = calloc(1, sizeof(*gov));
+	
+	if (!gov)
+		return NULL;
+	pthread_mutex_init(&gov->lock, NULL);
+	return gov;
+}
+
+void cardinality_governor_destroy(struct cardinality_governor *gov)
+{
+	if (!gov)
+		return;
+	pthread_mutex_destroy(&gov->lock);
+	free(gov->names);
+	free(gov);
+}
+
+bool cardinality_governor_set_limits(struct cardinality_governor *gov, const char *name,
+                                     const struct cardinality_limits *limits)
+{
+	struct governed_name *entry;
+	bool ok = true;
+	
+	if (!gov || !limits)
+		return false;
+	
+	pthread_mutex_lock(&gov->lock);
+	if (!name) {
+		gov->defaults = *limits;
+	} else if ((entry = find_name(gov, name))) {
+		entry->limits = *limits;
+	} else {
+		ok = add_name(gov, name, limits) != NULL;
+	}
+	update_active(gov);
+	pthread_mutex_unlock(&gov->lock);
+	
+	return ok;
+}
+
+bool cardinality_governor_active(struct cardinality_governor *gov)
+{
+	return gov && __atomic_load_n(&gov->active, __ATOMIC_ACQUIRE);
+}
+
+bool cardinality_governor_admit(struct cardinality_governor *gov, const char *name)
+{
+	struct governed_name *entry;
+	bool admit = true;
+	
+	if (!cardinality_governor_active(gov))
+		return true;
+	
+	pthread_mutex_lock(&gov->lock);
+	entry = governed(gov, name);
+	if (entry) {
+		if (entry->limits.max_series && entry->series >= entry->limits.max_series) {
+			entry->rejected++;
+			admit = false;
+		} else {
+			entry->series++;
+		}
+	}
+	pthread_mutex_unlock(&gov->lock);
+	
+	return admit;
+}
+
+void cardinality_series_init(struct cardinality_series *series, uint64_t now_ms)
+{
+	memset(series, 0, sizeof(*series));
+	series->changed_ms = now_ms;
+}
+
+void cardinality_series_update(struct cardinality_series *series, uint64_t progress,
+                               bool monotonic, uint64_t now_ms)
+{
+	if (progress == series->progress) {
+		series->activity = 0;
+		return;
+	}
+	
+	if (monotonic && progress > series->progress)
+		series->activity = progress - series->progress;
+	else
+		series->activity = 1;
+	series->progress = progress;
+	series->changed_ms = now_ms;
+}
+
+size_t cardinality_governor_select(struct cardinality_governor *gov, const char *name,
+                                   struct cardinality_series **series, size_t n,
+                                   uint64_t now_ms)
+{
+	struct cardinality_limits limits = { 0 };
+	struct governed_name *entry;
+	size_t live = 0, folded = 0;
+	
+	if (cardinality_governor_active(gov)) {
+		pthread_mutex_lock(&gov->lock);
+		entry = governed(gov, name);
+		if (entry)
+			limits = entry->limits;
+		pthread_mutex_unlock(&gov->lock);
+	}
+	
+	/* Stale series go to the end */
+	for (size_t i = 0; i < n; i++) {
+		struct cardinality_series *s = series[i];
+	
+		if (limits.stale_ms && now_ms - s->changed_ms >= limits.stale_ms) {
+			s->verdict = CARDINALITY_EXPIRE;
+			continue;
+		}
+		s->verdict = CARDINALITY_SHOW;
+		series[i] = series[live];
+		series[live++] = s;
+	}
+	
+	if (limits.top_k && live > limits.top_k) {
+		/* Ties go to the series first, through a stable sort of a copy */
+		struct cardinality_series **order = malloc(live * sizeof(*order));
+	
+		if (order) {
+			memcpy(order, series, live * sizeof(*order));
+			for (size_t i = 1; i < live; i++) {
+				struct cardinality_series *s = order[i];
+				size_t j = i;
+	
+				while (j > 0 && order[j - 1]->activity < s->activity) {
+					order[j] = order[j - 1];
+					j--;
+				}
+				order[j] = s;
+			}
+			for (size_t i = limits.top_k; i < live; i++)
+				order[i]->verdict = CARDINALITY_FOLD;
+			folded = live - limits.top_k;
+			free(order);
+		}
+	}
+	
+	if (limits_set(&limits)) {
+		pthread_mutex_lock(&gov->lock);
+		entry = find_name(gov, name);
+		if (entry) {
+			entry->folded = folded;
+			entry->expired = n - live;
+		}
+		pthread_mutex_unlock(&gov->lock);
+	}
+	
+	return folded;
+}
+
+void cardinality_governor_for_each(struct cardinality_governor *gov,
+                                   void (*fn)(const struct cardinality_stats *stats, void *ctx),
+                                   void *ctx)
+{
+	char name[NAME_MAX_LEN];
+	struct cardinality_stats stats = { .name = name };
+	
+	if (!gov || !fn)
+		return;
+	
+	/* Copied out one at a time so that fn can register series */
+	for (size_t i = 0; ; i++) {
+		struct governed_name *entry;
+		bool set;
+		
+		pthread_mutex_lock(&gov->lock);
+		if (i >= gov->count) {
+			pthread_mutex_unlock(&gov->lock);
+			break;
+		}
+		entry = &gov->names[i];
+		set = limits_set(&entry->limits);
+		strcpy(name, entry->name);
+		stats.series = entry->series;
+		stats.rejected = entry->rejected;
+		stats.folded = entry->folded;
+		stats.expired = entry->expired;
+		pthread_mutex_unlock(&gov->lock);
+		
+		if (set)
+			fn(&stats, ctx);
+	}
+}
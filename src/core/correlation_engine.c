@@ -1,38 +1,141 @@
 /* correlation_engine.c - Event correlation rule engine
  *
  * Implements correlation rule parsing, evaluation, and correlation ID
- * generation for grouping related network events.
+ * generation for grouping related network events. Results are fixed-size
+ * records with a numeric ID that refer to their rule, so a correlation
+ * allocates nothing and formats no strings.
+ *
+ * Rules with a same-interface condition count events per interface. That
+ * state is partitioned by interface name into lock-striped shards, so
+ * events of different interfaces are correlated in parallel on the
+ * threads calling correlation_engine_process(). Rules over all events
+ * keep one counter each behind the aggregator lock, which is only held
+ * for the O(1) counter update. The rule table is read locked while
+ * events are processed and write locked to add or remove rules.
  */
 
 #include "correlation_engine.h"
 #include "event_processor.h"
+#include "window_counter.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <stdatomic.h>
 
 /* Correlation rule structure */
 struct correlation_rule {
 	int id;
 	struct correlation_rule_def def;
-	struct time_window *window;
+	struct window_counter *window;  /* Events in the rule's time window, unkeyed rules */
+	time_t window_sec;
+	bool keyed;                     /* Counted per interface */
 	bool active;
 };
 
+/* Per-interface state of keyed rules */
+struct correlation_key {
+	char interface[16];
+	time_t last_seen;
+	struct window_counter **windows; /* Per rule, created on first use */
+	struct correlation_key *next;
+};
+
+/* One stripe of the per-interface state */
+struct correlation_shard {
+	pthread_mutex_t lock;
+	struct correlation_key *keys;
+	size_t key_count;
+} __attribute__((aligned(64)));
+
 /* Correlation engine structure */
 struct correlation_engine {
 	struct correlation_rule *rules;
 	size_t rule_count;
 	size_t max_rules;
+	pthread_rwlock_t rules_lock;
+	struct correlation_shard *shards;
+	size_t shard_count;
 	struct time_window *global_window;
 	time_t default_window_sec;
-	unsigned long correlation_counter;
-	pthread_mutex_t lock;
+	pthread_mutex_t lock;           /* Aggregator, guards the unkeyed rule windows */
 };
 
+/* Next block of correlation IDs, block 0 is never handed out so no ID is 0 */
+static atomic_uint_fast64_t correlation_id_blocks = 1;
+
+/* IDs left in the calling thread's block */
+static _Thread_local correlation_id_t correlation_id_cursor;
+static _Thread_local correlation_id_t correlation_id_end;
+
+/* FNV-1a of the interface name */
+static size_t shard_index(struct correlation_engine *engine, const char *interface)
+{
+	uint32_t hash = 2166136261u;
+
+	for (size_t i = 0; i < 16 && interface[i]; i++) {
+		hash ^= (unsigned char)interface[i];
+		hash *= 16777619u;
+	}
+
+	return hash % engine->shard_count;
+}
+
+static void key_free(struct correlation_engine *engine, struct correlation_key *key)
+{
+	for (size_t i = 0; i < engine->max_rules; i++)
+		window_counter_destroy(key->windows[i]);
+	free(key->windows);
+	free(key);
+}
+
+/* State of interface in shard, called with the shard's lock held */
+static struct correlation_key *shard_key(struct correlation_engine *engine,
+                                         struct correlation_shard *shard,
+                                         const char *interface, time_t now)
+{
+	struct correlation_key *key, **link, **oldest = NULL;
+
+	for (link = &shard->keys; *link; link = &(*link)->next) {
+		key = *link;
+		if (strncmp(key->interface, interface, sizeof(key->interface)) == 0) {
+			key->last_seen = now;
+			return key;
+		}
+		if (!oldest || key->last_seen < (*oldest)->last_seen)
+			oldest = link;
+	}
+
+	/* Forget the interface seen longest ago to stay bounded */
+	if (shard->key_count >= CORRELATION_SHARD_KEYS && oldest) {
+		key = *oldest;
+		*oldest = key->next;
+		key_free(engine, key);
+		shard->key_count--;
+	}
+
+	key = calloc(1, sizeof(*key));
+	if (!key)
+		return NULL;
+
+	key->windows = calloc(engine->max_rules, sizeof(*key->windows));
+	if (!key->windows) {
+		free(key);
+		return NULL;
+	}
+
+	strncpy(key->interface, interface, sizeof(key->interface) - 1);
+	key->last_seen = now;
+	key->next = shard->keys;
+	shard->keys = key;
+	shard->key_count++;
+	return key;
+}
+
 struct correlation_engine *correlation_engine_create(struct correlation_config *config)
 {
 	struct correlation_engine *engine;
+	size_t i;
 
 	if (!config)
 		return NULL;
@@ -50,12 +153,22 @@ struct correlation_engine *correlation_engine_create(struct correlation_config *
 	engine->max_rules = config->max_rules;
 	engine->default_window_sec = config->default_window_sec;
 	engine->rule_count = 0;
-	engine->correlation_counter = 0;
+
+	engine->shard_count = config->shard_count ? config->shard_count :
+	                                            CORRELATION_DEFAULT_SHARDS;
+	engine->shards = aligned_alloc(64, engine->shard_count * sizeof(*engine->shards));
+	if (!engine->shards) {
+		free(engine->rules);
+		free(engine);
+		return NULL;
+	}
+	memset(engine->shards, 0, engine->shard_count * sizeof(*engine->shards));
 
 	/* Create global time window */
 	engine->global_window = time_window_create(config->default_window_sec,
 	                                           config->max_window_size);
 	if (!engine->global_window) {
+		free(engine->shards);
 		free(engine->rules);
 		free(engine);
 		return NULL;
@@ -63,29 +176,53 @@ struct correlation_engine *correlation_engine_create(struct correlation_config *
 
 	if (pthread_mutex_init(&engine->lock, NULL) != 0) {
 		time_window_destroy(engine->global_window);
+		free(engine->shards);
 		free(engine->rules);
 		free(engine);
 		return NULL;
 	}
 
+	if (pthread_rwlock_init(&engine->rules_lock, NULL) != 0) {
+		pthread_mutex_destroy(&engine->lock);
+		time_window_destroy(engine->global_window);
+		free(engine->shards);
+		free(engine->rules);
+		free(engine);
+		return NULL;
+	}
+
+	for (i = 0; i < engine->shard_count; i++)
+		pthread_mutex_init(&engine->shards[i].lock, NULL);
+
 	return engine;
 }
 
 void correlation_engine_destroy(struct correlation_engine *engine)
 {
+	struct correlation_key *key, *next;
 	size_t i;
 
 	if (!engine)
 		return;
 
+	/* Destroy per-interface state */
+	for (i = 0; i < engine->shard_count; i++) {
+		for (key = engine->shards[i].keys; key; key = next) {
+			next = key->next;
+			key_free(engine, key);
+		}
+		pthread_mutex_destroy(&engine->shards[i].lock);
+	}
+
 	/* Destroy rule-specific windows */
 	for (i = 0; i < engine->rule_count; i++) {
-		if (engine->rules[i].window)
-			time_window_destroy(engine->rules[i].window);
+		window_counter_destroy(engine->rules[i].window);
 	}
 
 	time_window_destroy(engine->global_window);
+	pthread_rwlock_destroy(&engine->rules_lock);
 	pthread_mutex_destroy(&engine->lock);
+	free(engine->shards);
 	free(engine->rules);
 	free(engine);
 }
@@ -95,14 +232,15 @@ int correlation_engine_add_rule(struct correlation_engine *engine,
 {
 	struct correlation_rule *rule;
 	int rule_id;
+	size_t i;
 
 	if (!engine || !rule_def)
 		return -1;
 
-	pthread_mutex_lock(&engine->lock);
+	pthread_rwlock_wrlock(&engine->rules_lock);
 
 	if (engine->rule_count >= engine->max_rules) {
-		pthread_mutex_unlock(&engine->lock);
+		pthread_rwlock_unlock(&engine->rules_lock);
 		return -1;
 	}
 
@@ -113,124 +251,64 @@ int correlation_engine_add_rule(struct correlation_engine *engine,
 	memcpy(&rule->def, rule_def, sizeof(struct correlation_rule_def));
 	rule->id = rule_id;
 	rule->active = true;
+	rule->keyed = false;
+	for (i = 0; i < rule_def->condition_count && i < 8; i++) {
+		if (rule_def->conditions[i].type == CORR_COND_SAME_INTERFACE)
+			rule->keyed = true;
+	}
 
-	/* Create time window for this rule */
-	time_t window_sec = rule_def->time_window_sec > 0 ?
-	                    rule_def->time_window_sec : engine->default_window_sec;
-	rule->window = time_window_create(window_sec, 1000);
-	if (!rule->window) {
-		pthread_mutex_unlock(&engine->lock);
-		return -1;
+	/* Create time window for this rule, keyed rules get one per interface */
+	rule->window_sec = rule_def->time_window_sec > 0 ?
+	                   rule_def->time_window_sec : engine->default_window_sec;
+	if (!rule->keyed) {
+		rule->window = window_counter_create(rule->window_sec);
+		if (!rule->window) {
+			pthread_rwlock_unlock(&engine->rules_lock);
+			return -1;
+		}
 	}
 
 	engine->rule_count++;
 
-	pthread_mutex_unlock(&engine->lock);
+	pthread_rwlock_unlock(&engine->rules_lock);
 	return rule_id;
 }
 
 void correlation_engine_remove_rule(struct correlation_engine *engine, int rule_id)
 {
+	struct correlation_key *key;
+	size_t i;
+
 	if (!engine || rule_id < 0 || (size_t)rule_id >= engine->rule_count)
 		return;
 
-	pthread_mutex_lock(&engine->lock);
+	pthread_rwlock_wrlock(&engine->rules_lock);
 
 	engine->rules[rule_id].active = false;
-	if (engine->rules[rule_id].window) {
-		time_window_destroy(engine->rules[rule_id].window);
-		engine->rules[rule_id].window = NULL;
+	window_counter_destroy(engine->rules[rule_id].window);
+	engine->rules[rule_id].window = NULL;
+
+	/* No event is being processed, the shards need no locks */
+	for (i = 0; i < engine->shard_count; i++) {
+		for (key = engine->shards[i].keys; key; key = key->next) {
+			window_counter_destroy(key->windows[rule_id]);
+			key->windows[rule_id] = NULL;
+		}
 	}
 
-	pthread_mutex_unlock(&engine->lock);
+	pthread_rwlock_unlock(&engine->rules_lock);
 }
 
-/* Check if event matches a condition */
-static bool match_condition(struct nlmon_event *event,
-                           struct correlation_rule_def *rule,
-                           size_t cond_idx)
+/* Fill in a result for rule with count events in its window */
+static void fill_result(struct correlation_rule *rule, struct correlation_result *result,
+                        size_t count, time_t current_time)
 {
-	if (cond_idx >= rule->condition_count)
-		return false;
-
-	switch (rule->conditions[cond_idx].type) {
-	case CORR_COND_EVENT_TYPE:
-		return event->event_type == rule->conditions[cond_idx].value.event_type;
-
-	case CORR_COND_INTERFACE:
-		return strcmp(event->interface, rule->conditions[cond_idx].value.interface) == 0;
-
-	case CORR_COND_MESSAGE_TYPE:
-		return event->message_type == rule->conditions[cond_idx].value.message_type;
-
-	case CORR_COND_SAME_INTERFACE:
-	case CORR_COND_COUNT:
-	case CORR_COND_RATE:
-		/* These conditions checked separately */
-		return true;
-
-	default:
-		return false;
-	}
-}
-
-/* Evaluate rule against events in window */
-__attribute__((unused))
-static bool evaluate_rule(struct correlation_rule *rule,
-                         struct nlmon_event *new_event,
-                         struct correlation_result *result)
-{
-	struct nlmon_event *window_events[1000];
-	size_t window_count;
-	size_t matched = 0;
-	size_t i, j;
-
-	/* Query events from rule's time window */
-	window_count = time_window_query(rule->window, 0, NULL,
-	                                 window_events, 1000);
-
-	/* Check if new event matches any condition */
-	bool new_event_matches = false;
-	for (i = 0; i < rule->def.condition_count; i++) {
-		if (match_condition(new_event, &rule->def, i)) {
-			new_event_matches = true;
-			break;
-		}
-	}
-
-	if (!new_event_matches)
-		return false;
-
-	/* Count matching events in window */
-	for (i = 0; i < window_count; i++) {
-		for (j = 0; j < rule->def.condition_count; j++) {
-			if (match_condition(window_events[i], &rule->def, j)) {
-				matched++;
-				break;
-			}
-		}
-	}
-
-	/* Add new event to matched count */
-	matched++;
-
-	/* Check if we have enough events for correlation */
-	if (matched < rule->def.event_count)
-		return false;
-
-	/* Build correlation result */
-	if (result) {
-		strncpy(result->rule_name, rule->def.name, sizeof(result->rule_name) - 1);
-		result->event_count = matched;
-		result->first_timestamp = window_count > 0 ? window_events[0]->timestamp : new_event->timestamp;
-		result->last_timestamp = new_event->timestamp;
-
-		/* Note: events array not allocated to avoid memory management complexity
-		 * Caller should query the time window directly if needed */
-		result->events = NULL;
-	}
-
-	return true;
+	result->id = correlation_id_next();
+	result->rule_id = rule->id;
+	result->rule_name = rule->def.name;
+	result->event_count = count;
+	result->first_timestamp = current_time - rule->def.time_window_sec;
+	result->last_timestamp = current_time;
 }
 
 size_t correlation_engine_process(struct correlation_engine *engine,
@@ -238,68 +316,101 @@ size_t correlation_engine_process(struct correlation_engine *engine,
                                   struct correlation_result *results,
                                   size_t max_results)
 {
+	struct correlation_shard *shard;
+	struct correlation_key *key = NULL;
 	size_t found = 0;
 	size_t i;
 	time_t current_time;
+	bool aggregated = false;
 
 	if (!engine || !event || !results || max_results == 0)
 		return 0;
 
 	current_time = event->timestamp;
 
-	pthread_mutex_lock(&engine->lock);
-
-	/* Add event to global window */
+	/* Add event to global window, it has its own lock */
 	time_window_add(engine->global_window, event);
 	time_window_expire(engine->global_window, current_time);
 
-	/* Evaluate each active rule */
+	pthread_rwlock_rdlock(&engine->rules_lock);
+
+	/* Rules counted per interface, in the event's shard */
+	shard = &engine->shards[shard_index(engine, event->interface)];
+	pthread_mutex_lock(&shard->lock);
+
 	for (i = 0; i < engine->rule_count && found < max_results; i++) {
 		struct correlation_rule *rule = &engine->rules[i];
+		struct window_counter **window;
+		size_t window_count;
 
-		if (!rule->active || !rule->window)
+		if (!rule->active)
+			continue;
+		if (!rule->keyed) {
+			aggregated = true;
 			continue;
+		}
 
-		/* Add event to rule's window */
-		time_window_add(rule->window, event);
-		time_window_expire(rule->window, current_time);
-
-		/* Simple correlation: check if we have enough events in window */
-		size_t window_count = time_window_count(rule->window);
-		if (window_count >= rule->def.event_count) {
-			/* Generate correlation result */
-			strncpy(results[found].rule_name, rule->def.name,
-			        sizeof(results[found].rule_name) - 1);
-			results[found].event_count = window_count;
-			results[found].first_timestamp = current_time - rule->def.time_window_sec;
-			results[found].last_timestamp = current_time;
-			results[found].events = NULL;
-
-			/* Generate correlation ID */
-			correlation_engine_generate_id(engine, rule->def.name,
-			                              results[found].correlation_id,
-			                              sizeof(results[found].correlation_id));
-			found++;
+		if (!key) {
+			key = shard_key(engine, shard, event->interface, current_time);
+			if (!key)
+				break;
+		}
+
+		window = &key->windows[i];
+		if (!*window) {
+			*window = window_counter_create(rule->window_sec);
+			if (!*window)
+				continue;
 		}
+
+		/* Add event to the interface's window of the rule */
+		window_counter_add(*window, current_time, 1);
+
+		window_count = window_counter_count(*window, current_time);
+		if (window_count >= rule->def.event_count)
+			fill_result(rule, &results[found++], window_count, current_time);
 	}
 
-	pthread_mutex_unlock(&engine->lock);
+	pthread_mutex_unlock(&shard->lock);
+
+	/* Rules over all events, through the aggregator */
+	if (aggregated && found < max_results) {
+		pthread_mutex_lock(&engine->lock);
+
+		for (i = 0; i < engine->rule_count && found < max_results; i++) {
+			struct correlation_rule *rule = &engine->rules[i];
+			size_t window_count;
+
+			if (!rule->active || rule->keyed || !rule->window)
+				continue;
+
+			/* Add event to rule's window */
+			window_counter_add(rule->window, current_time, 1);
+
+			/* Simple correlation: check if we have enough events in window */
+			window_count = window_counter_count(rule->window, current_time);
+			if (window_count >= rule->def.event_count)
+				fill_result(rule, &results[found++], window_count, current_time);
+		}
+
+		pthread_mutex_unlock(&engine->lock);
+	}
+
+	pthread_rwlock_unlock(&engine->rules_lock);
 	return found;
 }
 
-bool correlation_engine_generate_id(struct correlation_engine *engine,
-                                    const char *rule_name,
-                                    char *id_buf, size_t buf_size)
+correlation_id_t correlation_id_next(void)
 {
-	unsigned long counter;
-
-	if (!engine || !rule_name || !id_buf || buf_size == 0)
-		return false;
-
-	pthread_mutex_lock(&engine->lock);
-	counter = ++engine->correlation_counter;
-	pthread_mutex_unlock(&engine->lock);
+	correlation_id_t block;
+
+	if (correlation_id_cursor == correlation_id_end) {
+		block = atomic_fetch_add_explicit(&correlation_id_blocks, 1,
+		                                  memory_order_relaxed);
+		correlation_id_cursor = block << CORRELATION_ID_BLOCK_BITS;
+		correlation_id_end = correlation_id_cursor +
+		                     ((correlation_id_t)1 << CORRELATION_ID_BLOCK_BITS);
+	}
 
-	snprintf(id_buf, buf_size, "%s-%lu", rule_name, counter);
-	return true;
+	return correlation_id_cursor++;
 }
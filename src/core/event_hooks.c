@@ -1,7 +1,17 @@
 /* event_hooks.c - Event hook system implementation
  *
- * Implements script execution with fork/exec, event data passing via
- * environment variables, timeout mechanism, and output capture.
+ * Implements script execution with posix_spawn, event data passing via
+ * environment variables and a timeout mechanism.
+ *
+ * Event workers match hooks on a published snapshot of the enabled
+ * hooks, read under an epoch instead of a lock, and queue matching
+ * events on each hook's bounded queue. One executor thread drains the
+ * queues within the concurrency limits and hands the children to one
+ * reaper thread, which polls them for their exit and kills those past
+ * their timeout.
+ * Persistent hooks keep one worker process per hook reading events as
+ * lines of JSON from a socket on its stdin, so matching events cost a
+ * write instead of a process.
  */
 
 #include <stdlib.h>
@@ -14,12 +24,37 @@
 #include <signal.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdarg.h>
 #include <pthread.h>
+#include <sched.h>
+#include <spawn.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
 #include <time.h>
 #include "event_hooks.h"
-#include "filter_parser.h"
+#include "filter_cache.h"
 #include "filter_compiler.h"
 #include "filter_eval.h"
+#include "nlmon_probes.h"
+#include "nlmon_clock.h"
+
+/* Time a stopped persistent worker gets to exit after its stdin closes */
+#define HOOK_WORKER_GRACE_MS 1000
+
+/* Least time between starts of a persistent worker */
+#define HOOK_WORKER_RESTART_MS 1000
+
+/* Longest the executor sleeps, so batch intervals are kept without events */
+#define HOOK_EXECUTOR_POLL_MS 10
+
+/* Environment variables of one execution, kept on the stack */
+#define HOOK_ENV_VARS 8
+struct hook_env {
+	char *envp[HOOK_ENV_VARS + 1];
+	size_t count;
+	char buf[320];                   /* Formatted event variables */
+	size_t used;
+};
 
 /* Hook entry */
 struct hook_entry {
@@ -29,14 +64,47 @@ struct hook_entry {
 	struct hook_stats stats;
 	pthread_mutex_t stats_mutex;
 	bool in_use;
+	size_t active;                   /* Executions running, guarded by exec_mutex */
+	
+	/* Matched events waiting for the executor, guarded by queue_mutex */
+	struct nlmon_event *queue;
+	uint32_t queue_size;
+	uint32_t queue_head;
+	uint32_t queue_count;
+	uint32_t sample_seen;            /* Events considered while sampling */
+	pthread_mutex_t queue_mutex;
+	char env_name[HOOK_MAX_NAME + 16]; /* NLMON_HOOK_NAME, the fixed part of the environment */
+	
+	/* Events of the next batched execution, guarded by hooks_mutex */
+	char *batch;                     /* Lines of JSON */
+	size_t batch_len;
+	size_t batch_size;
+	uint32_t batch_events;
+	uint64_t batch_started_ms;
+	struct nlmon_event batch_last;   /* Header of the latest event */
+	
+	/* Persistent worker, guarded by hooks_mutex */
+	pid_t worker;                    /* 0 if not running */
+	int worker_fd;                   /* Our end of its stdin */
+	uint64_t worker_started_ms;
+	char backlog[HOOK_MAX_LINE];     /* Rest of a line the worker could not take yet */
+	size_t backlog_len;
 };
 
-/* Async execution context */
-struct async_exec_ctx {
-	struct hook_manager *hm;
-	struct hook_entry *hook;
-	struct nlmon_event *event;
-	char **envp;
+/* Child process waited for by the reaper */
+struct hook_child {
+	pid_t pid;
+	struct hook_entry *hook;         /* NULL for a stopped persistent worker */
+	uint64_t start_ms;
+	uint64_t deadline_ms;
+	bool killed;
+	struct hook_child *next;
+};
+
+/* Enabled hooks as matched by hook_manager_execute(), never modified while published */
+struct hook_snapshot {
+	size_t count;
+	struct hook_entry *hooks[];
 };
 
 /* Hook manager structure */
@@ -45,249 +113,766 @@ struct hook_manager {
 	size_t max_hooks;
 	size_t max_concurrent;
 	int next_hook_id;
-	pthread_mutex_t hooks_mutex;
-	
-	/* Async execution tracking */
+	pthread_mutex_t hooks_mutex;     /* Guards the hooks and the executor's passes */
+	
+	/*
+	 * Published snapshot and the spare one, alternated so changes need
+	 * no allocation. Readers count in the parity of the epoch they
+	 * entered, writers flip it under hooks_mutex and wait for the old.
+	 */
+	_Atomic(struct hook_snapshot *) snapshot;
+	struct hook_snapshot *spare;
+	atomic_uint epoch;
+	atomic_ulong readers[2];
+	
+	/* Execution tracking */
 	size_t active_executions;
 	pthread_mutex_t exec_mutex;
 	pthread_cond_t exec_cond;
+	
+	/* Executor, woken on work_cond under exec_mutex while parked */
+	pthread_t executor;
+	pthread_cond_t work_cond;
+	atomic_bool executor_parked;
+	atomic_ulong queued;             /* Events on all hook queues */
+	atomic_ulong pushes;             /* Events ever queued, to spot new ones */
+	unsigned long flush_requested;   /* Flush generations, guarded by exec_mutex */
+	unsigned long flush_done;
+	bool executor_stop;
+	
+	/* Children of async executions and stopped workers, guarded by exec_mutex */
+	struct hook_child *children;
+	pthread_cond_t child_cond;
+	pthread_t reaper;
+	bool stopping;
 };
 
-/* Helper: Get current time in milliseconds */
-static uint64_t get_time_ms(void)
+/* Helper: Append a variable to env, dropped if it does not fit */
+static void env_add(struct hook_env *env, const char *fmt, ...)
+{
+	size_t room = sizeof(env->buf) - env->used;
+	va_list ap;
+	int len;
+	
+	if (env->count >= HOOK_ENV_VARS)
+		return;
+	
+	va_start(ap, fmt);
+	len = vsnprintf(env->buf + env->used, room, fmt, ap);
+	va_end(ap);
+	
+	if (len < 0 || (size_t)len >= room)
+		return;
+	
+	env->envp[env->count++] = env->buf + env->used;
+	env->envp[env->count] = NULL;
+	env->used += (size_t)len + 1;
+}
+
+/* Helper: Start env with the variables hook has for every execution */
+static void env_init(struct hook_env *env, struct hook_entry *hook)
 {
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	/* Fixed parts come from the hook, only event fields are formatted */
+	env->envp[0] = hook->env_name;
+	env->envp[1] = (char *)"PATH=/usr/local/bin:/usr/bin:/bin";
+	env->envp[2] = NULL;
+	env->count = 2;
+	env->used = 0;
 }
 
 /* Helper: Build environment variables from event */
-static char **build_event_env(struct nlmon_event *event)
+static void build_event_env(struct hook_env *env, struct hook_entry *hook,
+                            const struct nlmon_event *event)
 {
-	char **envp;
-	int count = 0;
-	char buf[256];
-	
-	/* Allocate environment array (max 20 variables + NULL) */
-	envp = calloc(21, sizeof(char *));
-	if (!envp)
-		return NULL;
+	env_init(env, hook);
 	
 	/* Add event fields as environment variables */
-	snprintf(buf, sizeof(buf), "NLMON_TIMESTAMP=%lu", event->timestamp);
-	envp[count++] = strdup(buf);
+	env_add(env, "NLMON_TIMESTAMP=%lu", event->timestamp);
+	env_add(env, "NLMON_SEQUENCE=%lu", event->sequence);
+	env_add(env, "NLMON_EVENT_TYPE=%u", event->event_type);
+	env_add(env, "NLMON_MESSAGE_TYPE=%u", event->message_type);
+	
+	if (event->interface[0] != '\0')
+		env_add(env, "NLMON_INTERFACE=%.*s", (int)sizeof(event->interface),
+		        event->interface);
+}
+
+/*
+ * Helper: Start script through the shell
+ *
+ * stdin is taken from in_fd and stdout/stderr go to out_fd, -1 keeps
+ * stdin and sends the output to /dev/null. posix_spawn() does not copy
+ * the address space as fork() does, so starting a child costs the same
+ * however large the monitor has grown.
+ */
+static pid_t spawn_script(const char *script, char **envp, int in_fd, int out_fd)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t mask, defaults;
+	char *argv[] = { "sh", "-c", (char *)script, NULL };
+	pid_t pid;
+	int err;
+	
+	if (posix_spawn_file_actions_init(&actions) != 0)
+		return -1;
+	if (posix_spawnattr_init(&attr) != 0) {
+		posix_spawn_file_actions_destroy(&actions);
+		return -1;
+	}
+	
+	if (in_fd >= 0)
+		posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+	if (out_fd >= 0) {
+		posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+		posix_spawn_file_actions_adddup2(&actions, out_fd, STDERR_FILENO);
+	} else {
+		posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+		posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+	}
+	
+	/* Scripts start with no signals blocked or ignored by the monitor */
+	sigemptyset(&mask);
+	sigfillset(&defaults);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	posix_spawnattr_setsigdefault(&attr, &defaults);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
 	
-	snprintf(buf, sizeof(buf), "NLMON_SEQUENCE=%lu", event->sequence);
-	envp[count++] = strdup(buf);
+	err = posix_spawn(&pid, "/bin/sh", &actions, &attr, argv, envp);
 	
-	snprintf(buf, sizeof(buf), "NLMON_EVENT_TYPE=%u", event->event_type);
-	envp[count++] = strdup(buf);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	return err == 0 ? pid : -1;
+}
+
+/* Helper: Account for one execution of hook */
+static void record_result(struct hook_entry *hook, enum hook_result result,
+                          uint64_t duration)
+{
+	pthread_mutex_lock(&hook->stats_mutex);
+	hook->stats.executions++;
+	hook->stats.total_duration_ms += duration;
 	
-	snprintf(buf, sizeof(buf), "NLMON_MESSAGE_TYPE=%u", event->message_type);
-	envp[count++] = strdup(buf);
+	if (hook->stats.min_duration_ms == 0 || duration < hook->stats.min_duration_ms)
+		hook->stats.min_duration_ms = duration;
+	if (duration > hook->stats.max_duration_ms)
+		hook->stats.max_duration_ms = duration;
 	
-	if (event->interface[0] != '\0') {
-		snprintf(buf, sizeof(buf), "NLMON_INTERFACE=%s", event->interface);
-		envp[count++] = strdup(buf);
+	switch (result) {
+	case HOOK_RESULT_SUCCESS:
+		hook->stats.successes++;
+		break;
+	case HOOK_RESULT_TIMEOUT:
+		hook->stats.timeouts++;
+		break;
+	case HOOK_RESULT_ERROR:
+		hook->stats.failures++;
+		break;
+	default:
+		break;
 	}
+	pthread_mutex_unlock(&hook->stats_mutex);
+}
+
+/* Helper: End an execution of hook, exec_mutex held */
+static void exec_release_locked(struct hook_manager *hm, struct hook_entry *hook)
+{
+	hm->active_executions--;
+	hook->active--;
+	pthread_cond_broadcast(&hm->exec_cond);
+	pthread_cond_signal(&hm->work_cond);
+}
+
+static void exec_release(struct hook_manager *hm, struct hook_entry *hook)
+{
+	pthread_mutex_lock(&hm->exec_mutex);
+	exec_release_locked(hm, hook);
+	pthread_mutex_unlock(&hm->exec_mutex);
+}
+
+/* Helper: Hand a child to the reaper */
+static bool child_add(struct hook_manager *hm, pid_t pid, struct hook_entry *hook,
+                      uint64_t start_ms, uint32_t timeout_ms)
+{
+	struct hook_child *child = calloc(1, sizeof(*child));
 	
-	/* Add PATH for script execution */
-	envp[count++] = strdup("PATH=/usr/local/bin:/usr/bin:/bin");
+	if (!child)
+		return false;
 	
-	/* NULL terminate */
-	envp[count] = NULL;
+	child->pid = pid;
+	child->hook = hook;
+	child->start_ms = start_ms;
+	child->deadline_ms = start_ms + timeout_ms;
 	
-	return envp;
+	pthread_mutex_lock(&hm->exec_mutex);
+	child->next = hm->children;
+	hm->children = child;
+	pthread_cond_signal(&hm->child_cond);
+	pthread_mutex_unlock(&hm->exec_mutex);
+	return true;
 }
 
-/* Helper: Free environment variables */
-static void free_event_env(char **envp)
+/* Reaper thread, waits for all children with their timeouts */
+static void *reaper_thread(void *arg)
 {
-	int i;
+	struct hook_manager *hm = arg;
+	
+	pthread_mutex_lock(&hm->exec_mutex);
 	
-	if (!envp)
+	while (!hm->stopping || hm->children) {
+		struct hook_child *child, **link;
+		struct timespec ts;
+		uint64_t now;
+		
+		if (!hm->children) {
+			pthread_cond_wait(&hm->child_cond, &hm->exec_mutex);
+			continue;
+		}
+		
+		now = nlmon_clock_monotonic_ms();
+		for (link = &hm->children; (child = *link); ) {
+			enum hook_result result;
+			int status;
+			pid_t ret = waitpid(child->pid, &status, WNOHANG);
+			
+			if (ret == 0 || (ret < 0 && errno == EINTR)) {
+				/* Timeout or abandoned execution - kill child, reaped on a later pass */
+				if (!child->killed &&
+				    (now >= child->deadline_ms || (hm->stopping && child->hook))) {
+					kill(child->pid, SIGKILL);
+					child->killed = true;
+				}
+				link = &child->next;
+				continue;
+			}
+			
+			*link = child->next;
+			if (child->hook) {
+				if (child->killed)
+					result = HOOK_RESULT_TIMEOUT;
+				else if (ret == child->pid && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+					result = HOOK_RESULT_SUCCESS;
+				else
+					result = HOOK_RESULT_ERROR;
+				record_result(child->hook, result, now - child->start_ms);
+				exec_release_locked(hm, child->hook);
+			}
+			free(child);
+		}
+		
+		/* Children are polled, SIGCHLD belongs to the application */
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 10000000;  /* 10ms */
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&hm->child_cond, &hm->exec_mutex, &ts);
+	}
+	
+	pthread_mutex_unlock(&hm->exec_mutex);
+	return NULL;
+}
+
+/* Helper: Start asynchronous execution of hook, a slot is reserved */
+static void execute_async(struct hook_manager *hm, struct hook_entry *hook,
+                          char **envp, int in_fd)
+{
+	uint64_t start_time = nlmon_clock_monotonic_ms();
+	pid_t pid = spawn_script(hook->config.script, envp, in_fd, -1);
+	
+	if (pid < 0) {
+		record_result(hook, HOOK_RESULT_ERROR, 0);
+		exec_release(hm, hook);
 		return;
+	}
 	
-	for (i = 0; envp[i]; i++)
-		free(envp[i]);
-	free(envp);
+	if (!child_add(hm, pid, hook, start_time, hook->config.timeout_ms)) {
+		/* Not waited for otherwise, reap it here */
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		record_result(hook, HOOK_RESULT_ERROR, nlmon_clock_monotonic_ms() - start_time);
+		exec_release(hm, hook);
+	}
 }
 
-/* Helper: Execute script with timeout */
-static enum hook_result execute_script(const char *script, char **envp,
-                                       uint32_t timeout_ms,
-                                       bool capture_output,
-                                       char *output, size_t output_size)
+/* Helper: Stop the persistent worker of hook, hooks_mutex held */
+static void worker_stop(struct hook_manager *hm, struct hook_entry *hook)
 {
-	pid_t pid;
-	int status;
-	int pipefd[2] = {-1, -1};
-	uint64_t start_time, elapsed;
-	struct timespec ts;
+	if (hook->worker <= 0)
+		return;
 	
-	/* Create pipe for output capture if requested */
-	if (capture_output && output && output_size > 0) {
-		if (pipe(pipefd) < 0)
-			return HOOK_RESULT_ERROR;
+	/* End of input asks the worker to exit, the reaper makes sure */
+	close(hook->worker_fd);
+	if (!child_add(hm, hook->worker, NULL, nlmon_clock_monotonic_ms(), HOOK_WORKER_GRACE_MS)) {
+		kill(hook->worker, SIGKILL);
+		waitpid(hook->worker, NULL, 0);
 	}
 	
-	start_time = get_time_ms();
+	hook->worker = 0;
+	hook->worker_fd = -1;
+	hook->backlog_len = 0;
+}
+
+/* Helper: Start the persistent worker of hook, hooks_mutex held */
+static bool worker_start(struct hook_entry *hook)
+{
+	uint64_t now = nlmon_clock_monotonic_ms();
+	struct hook_env env;
+	int fds[2];
+	pid_t pid;
+	
+	if (hook->worker_started_ms && now - hook->worker_started_ms < HOOK_WORKER_RESTART_MS)
+		return false;
+	
+	/* A socket rather than a pipe, send() can then refuse without SIGPIPE */
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+		return false;
+	shutdown(fds[0], SHUT_RD);
+	
+	env_init(&env, hook);
+	pid = spawn_script(hook->config.script, env.envp, fds[1], -1);
+	close(fds[1]);
 	
-	/* Fork child process */
-	pid = fork();
 	if (pid < 0) {
-		if (pipefd[0] >= 0) {
-			close(pipefd[0]);
-			close(pipefd[1]);
+		close(fds[0]);
+		return false;
+	}
+	
+	pthread_mutex_lock(&hook->stats_mutex);
+	if (hook->worker_started_ms)
+		hook->stats.restarts++;
+	pthread_mutex_unlock(&hook->stats_mutex);
+	
+	hook->worker = pid;
+	hook->worker_fd = fds[0];
+	hook->worker_started_ms = now;
+	hook->backlog_len = 0;
+	return true;
+}
+
+/* Helper: Format event as a line of JSON */
+static size_t format_event_line(const struct nlmon_event *event, char *line, size_t size)
+{
+	char interface[2 * sizeof(event->interface) + 1];
+	size_t len = 0;
+	int n;
+	
+	for (size_t i = 0; i < sizeof(event->interface) && event->interface[i]; i++) {
+		unsigned char c = (unsigned char)event->interface[i];
+		
+		if (c == '"' || c == '\\')
+			interface[len++] = '\\';
+		interface[len++] = c < 0x20 ? '?' : (char)c;
+	}
+	interface[len] = '\0';
+	
+	n = snprintf(line, size,
+	             "{\"timestamp\":%lu,\"sequence\":%lu,\"event_type\":%u,"
+	             "\"message_type\":%u,\"interface\":\"%s\"}\n",
+	             event->timestamp, event->sequence, event->event_type,
+	             event->message_type, interface);
+	return n > 0 && (size_t)n < size ? (size_t)n : 0;
+}
+
+/* Helper: Send bytes to worker, returns bytes taken or -1 if it is gone */
+static ssize_t worker_send(struct hook_entry *hook, const char *buf, size_t len)
+{
+	ssize_t n = send(hook->worker_fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+	
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return 0;
+	return n;
+}
+
+/* Helper: Pass event to the persistent worker of hook, hooks_mutex held */
+static void worker_deliver(struct hook_manager *hm, struct hook_entry *hook,
+                           struct nlmon_event *event)
+{
+	char line[HOOK_MAX_LINE];
+	size_t len = format_event_line(event, line, sizeof(line));
+	enum hook_result result = HOOK_RESULT_ERROR;
+	ssize_t n;
+	
+	if (hook->worker <= 0 && !worker_start(hook))
+		goto out;
+	
+	/* A line cut short must be completed before the next one starts */
+	if (hook->backlog_len > 0) {
+		n = worker_send(hook, hook->backlog, hook->backlog_len);
+		if (n < 0) {
+			worker_stop(hm, hook);
+			goto out;
 		}
-		return HOOK_RESULT_ERROR;
+		memmove(hook->backlog, hook->backlog + n, hook->backlog_len - (size_t)n);
+		hook->backlog_len -= (size_t)n;
+		if (hook->backlog_len > 0)
+			goto out;
+	}
+	
+	/* The worker has not read the earlier events yet, drop this one */
+	n = worker_send(hook, line, len);
+	if (n < 0) {
+		worker_stop(hm, hook);
+		goto out;
+	}
+	if (n == 0)
+		goto out;
+	
+	memcpy(hook->backlog, line + n, len - (size_t)n);
+	hook->backlog_len = len - (size_t)n;
+	result = HOOK_RESULT_SUCCESS;
+	
+out:
+	record_result(hook, result, 0);
+}
+
+/* Helper: Reserve an execution slot for hook, false if a limit is reached */
+static bool exec_try_acquire(struct hook_manager *hm, struct hook_entry *hook)
+{
+	/* Executions of a synchronous hook follow each other in event order */
+	uint32_t limit = hook->config.async ? hook->config.max_concurrent : 1;
+	bool ok;
+	
+	pthread_mutex_lock(&hm->exec_mutex);
+	ok = hm->active_executions < hm->max_concurrent && (limit == 0 || hook->active < limit);
+	if (ok) {
+		hm->active_executions++;
+		hook->active++;
 	}
+	pthread_mutex_unlock(&hm->exec_mutex);
+	return ok;
+}
+
+/* Helper: Whether hook collects events for batched executions */
+static bool hook_batched(const struct hook_entry *hook)
+{
+	return !hook->config.persistent &&
+	       (hook->config.batch_count > 1 || hook->config.batch_interval_ms > 0);
+}
+
+/* Helper: Add event to the batch of hook, hooks_mutex held */
+static bool batch_add(struct hook_entry *hook, const struct nlmon_event *event,
+                      uint64_t now)
+{
+	char line[HOOK_MAX_LINE];
+	size_t len = format_event_line(event, line, sizeof(line));
 	
-	if (pid == 0) {
-		/* Child process */
+	if (len == 0)
+		return false;
+	
+	if (hook->batch_len + len > hook->batch_size) {
+		size_t size = hook->batch_size ? hook->batch_size * 2 : 16 * HOOK_MAX_LINE;
+		char *batch;
 		
-		/* Redirect stdout/stderr to pipe if capturing */
-		if (pipefd[1] >= 0) {
-			dup2(pipefd[1], STDOUT_FILENO);
-			dup2(pipefd[1], STDERR_FILENO);
-			close(pipefd[0]);
-			close(pipefd[1]);
+		while (size < hook->batch_len + len)
+			size *= 2;
+		batch = realloc(hook->batch, size);
+		if (!batch)
+			return false;
+		hook->batch = batch;
+		hook->batch_size = size;
+	}
+	
+	memcpy(hook->batch + hook->batch_len, line, len);
+	hook->batch_len += len;
+	if (hook->batch_events++ == 0)
+		hook->batch_started_ms = now;
+	hook->batch_last = *event;
+	return true;
+}
+
+/* Helper: Whether the batch of hook is to run, hooks_mutex held */
+static bool batch_due(const struct hook_entry *hook, uint64_t now)
+{
+	if (hook->batch_events == 0)
+		return false;
+	if (hook->config.batch_count > 0 && hook->batch_events >= hook->config.batch_count)
+		return true;
+	return hook->config.batch_interval_ms > 0 &&
+	       now - hook->batch_started_ms >= hook->config.batch_interval_ms;
+}
+
+/* Helper: Run hook for its batch of events, false without a free slot, hooks_mutex held */
+static bool batch_run(struct hook_manager *hm, struct hook_entry *hook)
+{
+	struct hook_env env;
+	FILE *fp;
+	
+	if (!exec_try_acquire(hm, hook))
+		return false;
+	
+	/* Unlinked temporary file, the script may read it at its own pace */
+	fp = tmpfile();
+	if (fp) {
+		fcntl(fileno(fp), F_SETFD, FD_CLOEXEC);
+		if (fwrite(hook->batch, 1, hook->batch_len, fp) != hook->batch_len ||
+		    fflush(fp) != 0 || lseek(fileno(fp), 0, SEEK_SET) < 0) {
+			fclose(fp);
+			fp = NULL;
+		}
+	}
+	
+	if (fp) {
+		build_event_env(&env, hook, &hook->batch_last);
+		env_add(&env, "NLMON_BATCH_COUNT=%u", hook->batch_events);
+		execute_async(hm, hook, env.envp, fileno(fp));
+		fclose(fp);
+	} else {
+		record_result(hook, HOOK_RESULT_ERROR, 0);
+		exec_release(hm, hook);
+	}
+	
+	hook->batch_len = 0;
+	hook->batch_events = 0;
+	return true;
+}
+
+/* Helper: Count a matched event lost to the overflow policy */
+static void queue_shed(struct hook_entry *hook, unsigned long *counter)
+{
+	pthread_mutex_lock(&hook->stats_mutex);
+	(*counter)++;
+	pthread_mutex_unlock(&hook->stats_mutex);
+}
+
+/* Helper: Queue event for hook, returns true if the executor has new work */
+static bool queue_push(struct hook_manager *hm, struct hook_entry *hook,
+                       const struct nlmon_event *event)
+{
+	enum hook_overflow overflow = hook->config.overflow;
+	unsigned long *shed = NULL;
+	bool queued = false;
+	
+	pthread_mutex_lock(&hook->queue_mutex);
+	
+	if (hook->queue_count == hook->queue_size) {
+		if (overflow == HOOK_OVERFLOW_COALESCE) {
+			/* The newest queued event stands for both */
+			hook->queue[(hook->queue_head + hook->queue_count - 1) % hook->queue_size] = *event;
+			shed = &hook->stats.coalesced;
+			queued = true;
 		} else {
-			/* Redirect to /dev/null if not capturing */
-			int devnull = open("/dev/null", O_WRONLY);
-			if (devnull >= 0) {
-				dup2(devnull, STDOUT_FILENO);
-				dup2(devnull, STDERR_FILENO);
-				close(devnull);
-			}
+			shed = &hook->stats.dropped;
 		}
-		
-		/* Execute script via shell */
-		execle("/bin/sh", "sh", "-c", script, NULL, envp);
-		
-		/* If exec fails */
-		_exit(127);
+	} else if (overflow == HOOK_OVERFLOW_SAMPLE && hook->queue_count >= hook->queue_size / 2 &&
+	           hook->sample_seen++ % hook->config.sample_rate != 0) {
+		shed = &hook->stats.sampled;
+	} else {
+		hook->queue[(hook->queue_head + hook->queue_count) % hook->queue_size] = *event;
+		if (hook->queue_count++ < hook->queue_size / 2)
+			hook->sample_seen = 0;
+		atomic_fetch_add(&hm->queued, 1);
+		queued = true;
 	}
+	if (queued)
+		atomic_fetch_add(&hm->pushes, 1);
 	
-	/* Parent process */
-	if (pipefd[1] >= 0)
-		close(pipefd[1]);
+	pthread_mutex_unlock(&hook->queue_mutex);
 	
-	/* Read output if capturing */
-	if (pipefd[0] >= 0 && output && output_size > 0) {
-		ssize_t nread;
-		size_t total = 0;
-		
-		/* Set non-blocking */
-		fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
-		
-		while (total < output_size - 1) {
-			nread = read(pipefd[0], output + total, output_size - total - 1);
-			if (nread < 0) {
-				if (errno == EAGAIN || errno == EWOULDBLOCK)
+	if (shed)
+		queue_shed(hook, shed);
+	return queued;
+}
+
+/* Helper: Take the oldest queued event of hook */
+static bool queue_pop(struct hook_manager *hm, struct hook_entry *hook,
+                      struct nlmon_event *event)
+{
+	bool ok = false;
+	
+	pthread_mutex_lock(&hook->queue_mutex);
+	if (hook->queue_count > 0) {
+		*event = hook->queue[hook->queue_head];
+		hook->queue_head = (hook->queue_head + 1) % hook->queue_size;
+		hook->queue_count--;
+		atomic_fetch_sub(&hm->queued, 1);
+		ok = true;
+	}
+	pthread_mutex_unlock(&hook->queue_mutex);
+	return ok;
+}
+
+static bool queue_empty(struct hook_entry *hook)
+{
+	bool empty;
+	
+	pthread_mutex_lock(&hook->queue_mutex);
+	empty = hook->queue_count == 0;
+	pthread_mutex_unlock(&hook->queue_mutex);
+	return empty;
+}
+
+/* Helper: Forget the queued events of hook */
+static void queue_clear(struct hook_manager *hm, struct hook_entry *hook)
+{
+	pthread_mutex_lock(&hook->queue_mutex);
+	atomic_fetch_sub(&hm->queued, hook->queue_count);
+	hook->queue_head = 0;
+	hook->queue_count = 0;
+	pthread_mutex_unlock(&hook->queue_mutex);
+}
+
+/* Helper: Start what the queue of hook allows, returns true on progress, hooks_mutex held */
+static bool hook_drain(struct hook_manager *hm, struct hook_entry *hook, uint64_t now)
+{
+	struct nlmon_event event;
+	struct hook_env env;
+	bool progress = false;
+	
+	if (hook->config.persistent) {
+		while (queue_pop(hm, hook, &event)) {
+			worker_deliver(hm, hook, &event);
+			progress = true;
+		}
+		return progress;
+	}
+	
+	if (hook_batched(hook)) {
+		/* A full batch waits for its run before it takes more events */
+		for (;;) {
+			if (batch_due(hook, now)) {
+				if (!batch_run(hm, hook))
 					break;
-				break;
+				progress = true;
 			}
-			if (nread == 0)
+			if (!queue_pop(hm, hook, &event))
 				break;
-			total += nread;
+			if (!batch_add(hook, &event, now))
+				record_result(hook, HOOK_RESULT_ERROR, 0);
+			progress = true;
 		}
-		output[total] = '\0';
-		close(pipefd[0]);
+		return progress;
 	}
 	
-	/* Wait for child with timeout */
-	ts.tv_sec = timeout_ms / 1000;
-	ts.tv_nsec = (timeout_ms % 1000) * 1000000;
-	(void)ts; /* Reserved for future timeout implementation */
+	while (!queue_empty(hook) && exec_try_acquire(hm, hook)) {
+		if (!queue_pop(hm, hook, &event)) {
+			exec_release(hm, hook);
+			break;
+		}
+		build_event_env(&env, hook, &event);
+		execute_async(hm, hook, env.envp, -1);
+		progress = true;
+	}
+	return progress;
+}
+
+/* Helper: Start every pending batch, false if one lacks a slot, hooks_mutex held */
+static bool batches_flush(struct hook_manager *hm)
+{
+	bool done = true;
+	size_t i;
 	
-	while (1) {
-		pid_t result = waitpid(pid, &status, WNOHANG);
+	for (i = 0; i < hm->max_hooks; i++) {
+		struct hook_entry *hook = &hm->hooks[i];
 		
-		if (result == pid) {
-			/* Child exited */
-			if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
-				return HOOK_RESULT_SUCCESS;
-			return HOOK_RESULT_ERROR;
-		}
+		if (hook->in_use && hook->batch_events > 0 && !batch_run(hm, hook))
+			done = false;
+	}
+	return done;
+}
+
+/* Executor thread, drains the hook queues */
+static void *executor_thread(void *arg)
+{
+	struct hook_manager *hm = arg;
+	
+	pthread_mutex_lock(&hm->exec_mutex);
+	
+	while (!hm->executor_stop) {
+		unsigned long requested = hm->flush_requested;
+		unsigned long pushes = atomic_load(&hm->pushes);
+		bool progress = false, flushed = true;
+		uint64_t now = nlmon_clock_monotonic_ms();
+		struct timespec ts;
+		size_t i;
 		
-		if (result < 0) {
-			if (errno == EINTR)
-				continue;
-			return HOOK_RESULT_ERROR;
+		pthread_mutex_unlock(&hm->exec_mutex);
+		
+		pthread_mutex_lock(&hm->hooks_mutex);
+		for (i = 0; i < hm->max_hooks; i++) {
+			if (hm->hooks[i].in_use && hook_drain(hm, &hm->hooks[i], now))
+				progress = true;
 		}
+		if (requested != hm->flush_done)
+			flushed = batches_flush(hm);
+		pthread_mutex_unlock(&hm->hooks_mutex);
 		
-		/* Check timeout */
-		elapsed = get_time_ms() - start_time;
-		if (elapsed >= timeout_ms) {
-			/* Timeout - kill child */
-			kill(pid, SIGKILL);
-			waitpid(pid, &status, 0);
-			return HOOK_RESULT_TIMEOUT;
+		pthread_mutex_lock(&hm->exec_mutex);
+		if (flushed)
+			hm->flush_done = requested;
+		pthread_cond_broadcast(&hm->exec_cond);
+		
+		/* Go on while the pass got on with work that is left, or more came in */
+		if (progress && (atomic_load(&hm->queued) > 0 || !flushed))
+			continue;
+		atomic_store(&hm->executor_parked, true);
+		if (!hm->executor_stop && hm->flush_requested == requested &&
+		    atomic_load(&hm->pushes) == pushes) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += HOOK_EXECUTOR_POLL_MS * 1000000L;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&hm->work_cond, &hm->exec_mutex, &ts);
 		}
+		atomic_store(&hm->executor_parked, false);
+	}
+	
+	pthread_mutex_unlock(&hm->exec_mutex);
+	return NULL;
+}
+
+/* Helper: Wake the executor if it is parked */
+static void executor_wake(struct hook_manager *hm)
+{
+	if (!atomic_load(&hm->executor_parked))
+		return;
+	pthread_mutex_lock(&hm->exec_mutex);
+	pthread_cond_signal(&hm->work_cond);
+	pthread_mutex_unlock(&hm->exec_mutex);
+}
+
+/*
+ * Helper: Enter a snapshot read section, returning the parity to leave.
+ * The epoch is checked again once counted in, so a writer flipping it
+ * in between either waits for this reader or is seen on the retry.
+ */
+static unsigned int snapshot_enter(struct hook_manager *hm)
+{
+	for (;;) {
+		unsigned int epoch = atomic_load(&hm->epoch);
 		
-		/* Sleep briefly */
-		usleep(10000);  /* 10ms */
+		atomic_fetch_add(&hm->readers[epoch & 1], 1);
+		if (atomic_load(&hm->epoch) == epoch)
+			return epoch & 1;
+		atomic_fetch_sub(&hm->readers[epoch & 1], 1);
 	}
 }
 
-/* Async execution thread */
-static void *async_exec_thread(void *arg)
+static void snapshot_exit(struct hook_manager *hm, unsigned int parity)
 {
-	struct async_exec_ctx *ctx = arg;
-	struct hook_manager *hm = ctx->hm;
-	struct hook_entry *hook = ctx->hook;
-	struct nlmon_event *event = ctx->event;
-	char **envp = ctx->envp;
-	enum hook_result result;
-	uint64_t start_time, duration;
-	
-	start_time = get_time_ms();
-	
-	/* Execute script */
-	result = execute_script(hook->config.script, envp,
-	                       hook->config.timeout_ms,
-	                       false, NULL, 0);
-	
-	duration = get_time_ms() - start_time;
-	
-	/* Update statistics */
-	pthread_mutex_lock(&hook->stats_mutex);
-	hook->stats.executions++;
-	hook->stats.total_duration_ms += duration;
-	
-	if (hook->stats.min_duration_ms == 0 || duration < hook->stats.min_duration_ms)
-		hook->stats.min_duration_ms = duration;
-	if (duration > hook->stats.max_duration_ms)
-		hook->stats.max_duration_ms = duration;
+	atomic_fetch_sub_explicit(&hm->readers[parity], 1, memory_order_release);
+}
+
+/* Helper: Publish the enabled hooks and wait out readers of the old set, hooks_mutex held */
+static void snapshot_publish(struct hook_manager *hm)
+{
+	struct hook_snapshot *next = hm->spare;
+	unsigned int epoch;
+	size_t i;
 	
-	switch (result) {
-	case HOOK_RESULT_SUCCESS:
-		hook->stats.successes++;
-		break;
-	case HOOK_RESULT_TIMEOUT:
-		hook->stats.timeouts++;
-		break;
-	case HOOK_RESULT_ERROR:
-		hook->stats.failures++;
-		break;
-	default:
-		break;
+	next->count = 0;
+	for (i = 0; i < hm->max_hooks; i++) {
+		if (hm->hooks[i].in_use && hm->hooks[i].config.enabled)
+			next->hooks[next->count++] = &hm->hooks[i];
 	}
-	pthread_mutex_unlock(&hook->stats_mutex);
-	
-	/* Cleanup */
-	free_event_env(envp);
-	free(event);
-	free(ctx);
 	
-	/* Decrement active executions */
-	pthread_mutex_lock(&hm->exec_mutex);
-	hm->active_executions--;
-	pthread_cond_signal(&hm->exec_cond);
-	pthread_mutex_unlock(&hm->exec_mutex);
-	
-	return NULL;
+	hm->spare = atomic_exchange(&hm->snapshot, next);
+	epoch = atomic_fetch_add(&hm->epoch, 1);
+	while (atomic_load(&hm->readers[epoch & 1]))
+		sched_yield();
 }
 
 struct hook_manager *hook_manager_create(size_t max_hooks, size_t max_concurrent)
@@ -310,48 +895,81 @@ struct hook_manager *hook_manager_create(size_t max_hooks, size_t max_concurrent
 		return NULL;
 	}
 	
+	hm->spare = calloc(1, sizeof(struct hook_snapshot) + max_hooks * sizeof(struct hook_entry *));
+	atomic_init(&hm->snapshot,
+	            calloc(1, sizeof(struct hook_snapshot) + max_hooks * sizeof(struct hook_entry *)));
+	if (!hm->spare || !atomic_load(&hm->snapshot)) {
+		free(atomic_load(&hm->snapshot));
+		free(hm->spare);
+		free(hm->hooks);
+		free(hm);
+		return NULL;
+	}
+	
 	hm->max_hooks = max_hooks;
 	hm->max_concurrent = max_concurrent;
 	hm->next_hook_id = 1;
 	
 	/* Initialize mutexes */
-	if (pthread_mutex_init(&hm->hooks_mutex, NULL) != 0) {
-		free(hm->hooks);
-		free(hm);
-		return NULL;
-	}
+	if (pthread_mutex_init(&hm->hooks_mutex, NULL) != 0)
+		goto err_free;
 	
-	if (pthread_mutex_init(&hm->exec_mutex, NULL) != 0) {
-		pthread_mutex_destroy(&hm->hooks_mutex);
-		free(hm->hooks);
-		free(hm);
-		return NULL;
-	}
+	if (pthread_mutex_init(&hm->exec_mutex, NULL) != 0)
+		goto err_hooks_mutex;
 	
-	if (pthread_cond_init(&hm->exec_cond, NULL) != 0) {
-		pthread_mutex_destroy(&hm->exec_mutex);
-		pthread_mutex_destroy(&hm->hooks_mutex);
-		free(hm->hooks);
-		free(hm);
-		return NULL;
-	}
+	if (pthread_cond_init(&hm->exec_cond, NULL) != 0)
+		goto err_exec_mutex;
+	
+	if (pthread_cond_init(&hm->child_cond, NULL) != 0)
+		goto err_exec_cond;
+	
+	if (pthread_cond_init(&hm->work_cond, NULL) != 0)
+		goto err_child_cond;
 	
 	/* Initialize hook entry mutexes */
 	for (i = 0; i < max_hooks; i++) {
-		if (pthread_mutex_init(&hm->hooks[i].stats_mutex, NULL) != 0) {
-			/* Cleanup on failure */
-			for (size_t j = 0; j < i; j++)
-				pthread_mutex_destroy(&hm->hooks[j].stats_mutex);
-			pthread_cond_destroy(&hm->exec_cond);
-			pthread_mutex_destroy(&hm->exec_mutex);
-			pthread_mutex_destroy(&hm->hooks_mutex);
-			free(hm->hooks);
-			free(hm);
-			return NULL;
+		if (pthread_mutex_init(&hm->hooks[i].stats_mutex, NULL) != 0)
+			goto err_entries;
+		if (pthread_mutex_init(&hm->hooks[i].queue_mutex, NULL) != 0) {
+			pthread_mutex_destroy(&hm->hooks[i].stats_mutex);
+			goto err_entries;
 		}
 	}
 	
+	if (pthread_create(&hm->reaper, NULL, reaper_thread, hm) != 0)
+		goto err_entries;
+	
+	if (pthread_create(&hm->executor, NULL, executor_thread, hm) != 0) {
+		pthread_mutex_lock(&hm->exec_mutex);
+		hm->stopping = true;
+		pthread_cond_signal(&hm->child_cond);
+		pthread_mutex_unlock(&hm->exec_mutex);
+		pthread_join(hm->reaper, NULL);
+		goto err_entries;
+	}
+	
 	return hm;
+	
+err_entries:
+	while (i-- > 0) {
+		pthread_mutex_destroy(&hm->hooks[i].queue_mutex);
+		pthread_mutex_destroy(&hm->hooks[i].stats_mutex);
+	}
+	pthread_cond_destroy(&hm->work_cond);
+err_child_cond:
+	pthread_cond_destroy(&hm->child_cond);
+err_exec_cond:
+	pthread_cond_destroy(&hm->exec_cond);
+err_exec_mutex:
+	pthread_mutex_destroy(&hm->exec_mutex);
+err_hooks_mutex:
+	pthread_mutex_destroy(&hm->hooks_mutex);
+err_free:
+	free(atomic_load(&hm->snapshot));
+	free(hm->spare);
+	free(hm->hooks);
+	free(hm);
+	return NULL;
 }
 
 void hook_manager_destroy(struct hook_manager *hm, bool wait)
@@ -363,26 +981,70 @@ void hook_manager_destroy(struct hook_manager *hm, bool wait)
 	
 	/* Wait for pending executions if requested */
 	if (wait) {
+		hook_manager_flush(hm);
 		hook_manager_wait(hm);
 	}
 	
+	/* Without waiting, queued events are dropped */
+	pthread_mutex_lock(&hm->exec_mutex);
+	hm->executor_stop = true;
+	pthread_cond_signal(&hm->work_cond);
+	pthread_cond_broadcast(&hm->exec_cond);
+	pthread_mutex_unlock(&hm->exec_mutex);
+	pthread_join(hm->executor, NULL);
+	
+	/* Stop persistent workers, the reaper collects them */
+	pthread_mutex_lock(&hm->hooks_mutex);
+	for (i = 0; i < hm->max_hooks; i++) {
+		if (hm->hooks[i].in_use)
+			worker_stop(hm, &hm->hooks[i]);
+		free(hm->hooks[i].batch);
+		free(hm->hooks[i].queue);
+	}
+	pthread_mutex_unlock(&hm->hooks_mutex);
+	
+	/* Without waiting, executions still running are killed */
+	pthread_mutex_lock(&hm->exec_mutex);
+	hm->stopping = true;
+	pthread_cond_signal(&hm->child_cond);
+	pthread_mutex_unlock(&hm->exec_mutex);
+	pthread_join(hm->reaper, NULL);
+	
 	/* Cleanup hooks */
 	for (i = 0; i < hm->max_hooks; i++) {
 		if (hm->hooks[i].in_use && hm->hooks[i].filter)
 			filter_bytecode_free(hm->hooks[i].filter);
+		pthread_mutex_destroy(&hm->hooks[i].queue_mutex);
 		pthread_mutex_destroy(&hm->hooks[i].stats_mutex);
 	}
 	
+	free(atomic_load(&hm->snapshot));
+	free(hm->spare);
 	free(hm->hooks);
+	pthread_cond_destroy(&hm->work_cond);
+	pthread_cond_destroy(&hm->child_cond);
 	pthread_cond_destroy(&hm->exec_cond);
 	pthread_mutex_destroy(&hm->exec_mutex);
 	pthread_mutex_destroy(&hm->hooks_mutex);
 	free(hm);
 }
 
+/* Helper: Find the hook with hook_id, hooks_mutex held */
+static struct hook_entry *hook_find(struct hook_manager *hm, int hook_id)
+{
+	size_t i;
+	
+	for (i = 0; i < hm->max_hooks; i++) {
+		if (hm->hooks[i].in_use && hm->hooks[i].id == hook_id)
+			return &hm->hooks[i];
+	}
+	return NULL;
+}
+
 int hook_manager_register(struct hook_manager *hm, const struct hook_config *config)
 {
 	struct hook_entry *hook = NULL;
+	pthread_mutex_t stats_mutex, queue_mutex;
 	size_t i;
 	int id;
 	
@@ -390,7 +1052,8 @@ int hook_manager_register(struct hook_manager *hm, const struct hook_config *con
 		return -1;
 	
 	/* Validate configuration */
-	if (config->name[0] == '\0' || config->script[0] == '\0')
+	if (config->name[0] == '\0' || config->script[0] == '\0' ||
+	    config->overflow > HOOK_OVERFLOW_SAMPLE)
 		return -1;
 	
 	pthread_mutex_lock(&hm->hooks_mutex);
@@ -408,38 +1071,47 @@ int hook_manager_register(struct hook_manager *hm, const struct hook_config *con
 		return -1;
 	}
 	
-	/* Initialize hook */
+	/* Initialize hook, a free slot is in no snapshot and keeps its locks */
+	stats_mutex = hook->stats_mutex;
+	queue_mutex = hook->queue_mutex;
 	memset(hook, 0, sizeof(*hook));
+	hook->stats_mutex = stats_mutex;
+	hook->queue_mutex = queue_mutex;
 	id = hm->next_hook_id++;
 	hook->id = id;
 	hook->config = *config;
-	hook->in_use = true;
+	hook->worker_fd = -1;
+	snprintf(hook->env_name, sizeof(hook->env_name), "NLMON_HOOK_NAME=%s", config->name);
 	
 	/* Set default timeout if not specified */
 	if (hook->config.timeout_ms == 0)
 		hook->config.timeout_ms = 30000;  /* 30 seconds */
+	if (hook->config.queue_size == 0)
+		hook->config.queue_size = HOOK_DEFAULT_QUEUE;
+	if (hook->config.sample_rate == 0)
+		hook->config.sample_rate = HOOK_DEFAULT_SAMPLE_RATE;
+	
+	hook->queue_size = hook->config.queue_size;
+	hook->queue = calloc(hook->queue_size, sizeof(*hook->queue));
+	if (!hook->queue) {
+		pthread_mutex_unlock(&hm->hooks_mutex);
+		return -1;
+	}
 	
-	/* Compile filter condition if specified */
+	/* Compile filter condition if specified, shared with equal conditions */
 	if (config->condition[0] != '\0') {
-		struct filter_expr *expr = filter_parse(config->condition);
-		if (!expr || !expr->valid) {
-			if (expr)
-				filter_expr_free(expr);
-			hook->in_use = false;
-			pthread_mutex_unlock(&hm->hooks_mutex);
-			return -1;
-		}
-		
-		hook->filter = filter_compile(expr);
-		filter_expr_free(expr);
-		
+		hook->filter = filter_cache_get(config->condition, NULL);
 		if (!hook->filter) {
-			hook->in_use = false;
+			free(hook->queue);
+			hook->queue = NULL;
 			pthread_mutex_unlock(&hm->hooks_mutex);
 			return -1;
 		}
 	}
 	
+	hook->in_use = true;
+	snapshot_publish(hm);
+	
 	pthread_mutex_unlock(&hm->hooks_mutex);
 	
 	return id;
@@ -447,234 +1119,143 @@ int hook_manager_register(struct hook_manager *hm, const struct hook_config *con
 
 bool hook_manager_unregister(struct hook_manager *hm, int hook_id)
 {
-	struct hook_entry *hook = NULL;
-	size_t i;
+	struct hook_entry *hook;
 	
 	if (!hm)
 		return false;
 	
 	pthread_mutex_lock(&hm->hooks_mutex);
 	
-	/* Find hook */
-	for (i = 0; i < hm->max_hooks; i++) {
-		if (hm->hooks[i].in_use && hm->hooks[i].id == hook_id) {
-			hook = &hm->hooks[i];
-			break;
-		}
-	}
-	
+	hook = hook_find(hm, hook_id);
 	if (!hook) {
 		pthread_mutex_unlock(&hm->hooks_mutex);
 		return false;
 	}
 	
-	/* Cleanup */
+	/* Once no worker can still match it, nothing queues for it */
+	hook->in_use = false;
+	snapshot_publish(hm);
+	
+	/* Cleanup, queued events and those of a pending batch are dropped */
+	worker_stop(hm, hook);
+	queue_clear(hm, hook);
 	if (hook->filter)
 		filter_bytecode_free(hook->filter);
-	
-	hook->in_use = false;
+	hook->filter = NULL;
+	free(hook->batch);
+	hook->batch = NULL;
+	free(hook->queue);
+	hook->queue = NULL;
 	
 	pthread_mutex_unlock(&hm->hooks_mutex);
 	
 	return true;
 }
 
-bool hook_manager_enable(struct hook_manager *hm, int hook_id)
+/* Helper: Enable or disable a hook */
+static bool hook_set_enabled(struct hook_manager *hm, int hook_id, bool enabled)
 {
-	struct hook_entry *hook = NULL;
-	size_t i;
+	struct hook_entry *hook;
 	
 	if (!hm)
 		return false;
 	
 	pthread_mutex_lock(&hm->hooks_mutex);
 	
-	for (i = 0; i < hm->max_hooks; i++) {
-		if (hm->hooks[i].in_use && hm->hooks[i].id == hook_id) {
-			hook = &hm->hooks[i];
-			break;
-		}
+	hook = hook_find(hm, hook_id);
+	if (hook && hook->config.enabled != enabled) {
+		hook->config.enabled = enabled;
+		snapshot_publish(hm);
 	}
 	
-	if (hook)
-		hook->config.enabled = true;
-	
 	pthread_mutex_unlock(&hm->hooks_mutex);
 	
 	return hook != NULL;
 }
 
+bool hook_manager_enable(struct hook_manager *hm, int hook_id)
+{
+	return hook_set_enabled(hm, hook_id, true);
+}
+
 bool hook_manager_disable(struct hook_manager *hm, int hook_id)
 {
-	struct hook_entry *hook = NULL;
-	size_t i;
-	
-	if (!hm)
-		return false;
-	
-	pthread_mutex_lock(&hm->hooks_mutex);
-	
-	for (i = 0; i < hm->max_hooks; i++) {
-		if (hm->hooks[i].in_use && hm->hooks[i].id == hook_id) {
-			hook = &hm->hooks[i];
-			break;
-		}
-	}
-	
-	if (hook)
-		hook->config.enabled = false;
-	
-	pthread_mutex_unlock(&hm->hooks_mutex);
-	
-	return hook != NULL;
+	return hook_set_enabled(hm, hook_id, false);
 }
 
 void hook_manager_execute(struct hook_manager *hm, struct nlmon_event *event)
 {
+	const struct hook_snapshot *snapshot;
+	unsigned int parity;
+	bool queued = false;
 	size_t i;
 	
 	if (!hm || !event)
 		return;
 	
-	pthread_mutex_lock(&hm->hooks_mutex);
+	NLMON_PROBE1(hook_start, event->event_type);
 	
-	/* Iterate through all hooks */
-	for (i = 0; i < hm->max_hooks; i++) {
-		struct hook_entry *hook = &hm->hooks[i];
-		
-		if (!hook->in_use || !hook->config.enabled)
-			continue;
+	/* Hooks in the snapshot stay registered until the section is left */
+	parity = snapshot_enter(hm);
+	snapshot = atomic_load_explicit(&hm->snapshot, memory_order_acquire);
+	for (i = 0; i < snapshot->count; i++) {
+		struct hook_entry *hook = snapshot->hooks[i];
 		
 		/* Evaluate condition if present */
-		if (hook->filter) {
-			if (!filter_eval(hook->filter, event, NULL))
-				continue;
-		}
-		
-		/* Check concurrent execution limit */
-		pthread_mutex_lock(&hm->exec_mutex);
-		while (hm->active_executions >= hm->max_concurrent) {
-			pthread_cond_wait(&hm->exec_cond, &hm->exec_mutex);
-		}
-		hm->active_executions++;
-		pthread_mutex_unlock(&hm->exec_mutex);
+		if (hook->filter && !filter_eval(hook->filter, event, NULL))
+			continue;
 		
-		/* Execute hook */
-		if (hook->config.async) {
-			/* Async execution */
-			struct async_exec_ctx *ctx = malloc(sizeof(*ctx));
-			if (ctx) {
-				struct nlmon_event *event_copy = malloc(sizeof(*event));
-				if (event_copy) {
-					memcpy(event_copy, event, sizeof(*event));
-					ctx->hm = hm;
-					ctx->hook = hook;
-					ctx->event = event_copy;
-					ctx->envp = build_event_env(event);
-					
-					pthread_t thread;
-					if (pthread_create(&thread, NULL, async_exec_thread, ctx) == 0) {
-						pthread_detach(thread);
-					} else {
-						free(event_copy);
-						free_event_env(ctx->envp);
-						free(ctx);
-						pthread_mutex_lock(&hm->exec_mutex);
-						hm->active_executions--;
-						pthread_cond_signal(&hm->exec_cond);
-						pthread_mutex_unlock(&hm->exec_mutex);
-					}
-				} else {
-					free(ctx);
-					pthread_mutex_lock(&hm->exec_mutex);
-					hm->active_executions--;
-					pthread_cond_signal(&hm->exec_cond);
-					pthread_mutex_unlock(&hm->exec_mutex);
-				}
-			} else {
-				pthread_mutex_lock(&hm->exec_mutex);
-				hm->active_executions--;
-				pthread_cond_signal(&hm->exec_cond);
-				pthread_mutex_unlock(&hm->exec_mutex);
-			}
-		} else {
-			/* Synchronous execution */
-			char **envp = build_event_env(event);
-			enum hook_result result;
-			uint64_t start_time, duration;
-			
-			start_time = get_time_ms();
-			result = execute_script(hook->config.script, envp,
-			                       hook->config.timeout_ms,
-			                       false, NULL, 0);
-			duration = get_time_ms() - start_time;
-			
-			/* Update statistics */
-			pthread_mutex_lock(&hook->stats_mutex);
-			hook->stats.executions++;
-			hook->stats.total_duration_ms += duration;
-			
-			if (hook->stats.min_duration_ms == 0 || duration < hook->stats.min_duration_ms)
-				hook->stats.min_duration_ms = duration;
-			if (duration > hook->stats.max_duration_ms)
-				hook->stats.max_duration_ms = duration;
-			
-			switch (result) {
-			case HOOK_RESULT_SUCCESS:
-				hook->stats.successes++;
-				break;
-			case HOOK_RESULT_TIMEOUT:
-				hook->stats.timeouts++;
-				break;
-			case HOOK_RESULT_ERROR:
-				hook->stats.failures++;
-				break;
-			default:
-				break;
-			}
-			pthread_mutex_unlock(&hook->stats_mutex);
-			
-			free_event_env(envp);
-			
-			pthread_mutex_lock(&hm->exec_mutex);
-			hm->active_executions--;
-			pthread_cond_signal(&hm->exec_cond);
-			pthread_mutex_unlock(&hm->exec_mutex);
-		}
+		if (queue_push(hm, hook, event))
+			queued = true;
 	}
+	snapshot_exit(hm, parity);
 	
-	pthread_mutex_unlock(&hm->hooks_mutex);
+	if (queued)
+		executor_wake(hm);
+	NLMON_PROBE1(hook_done, event->event_type);
+}
+
+void hook_manager_flush(struct hook_manager *hm)
+{
+	unsigned long flush;
+	
+	if (!hm)
+		return;
+	
+	/* The executor runs the batches, collecting queued events first */
+	pthread_mutex_lock(&hm->exec_mutex);
+	flush = ++hm->flush_requested;
+	pthread_cond_signal(&hm->work_cond);
+	while (!hm->executor_stop && (long)(hm->flush_done - flush) < 0)
+		pthread_cond_wait(&hm->exec_cond, &hm->exec_mutex);
+	pthread_mutex_unlock(&hm->exec_mutex);
 }
 
 bool hook_manager_get_stats(struct hook_manager *hm, int hook_id,
                             struct hook_stats *stats)
 {
-	struct hook_entry *hook = NULL;
-	size_t i;
+	struct hook_entry *hook;
 	
 	if (!hm || !stats)
 		return false;
 	
 	pthread_mutex_lock(&hm->hooks_mutex);
 	
-	for (i = 0; i < hm->max_hooks; i++) {
-		if (hm->hooks[i].in_use && hm->hooks[i].id == hook_id) {
-			hook = &hm->hooks[i];
-			break;
-		}
-	}
-	
+	hook = hook_find(hm, hook_id);
 	if (hook) {
 		pthread_mutex_lock(&hook->stats_mutex);
 		*stats = hook->stats;
 		pthread_mutex_unlock(&hook->stats_mutex);
+		
+		pthread_mutex_lock(&hook->queue_mutex);
+		stats->queued = hook->queue_count;
+		pthread_mutex_unlock(&hook->queue_mutex);
 	}
 	
 	pthread_mutex_unlock(&hm->hooks_mutex);
 	
 	return hook != NULL;
 }
-
 void hook_manager_reset_stats(struct hook_manager *hm, int hook_id)
 {
 	size_t i;
@@ -753,8 +1334,10 @@ void hook_manager_wait(struct hook_manager *hm)
 	if (!hm)
 		return;
 	
+	/* The executor broadcasts after each pass, the reaper as executions end */
 	pthread_mutex_lock(&hm->exec_mutex);
-	while (hm->active_executions > 0) {
+	while (!hm->executor_stop && (atomic_load(&hm->queued) > 0 || hm->active_executions > 0)) {
+		pthread_cond_signal(&hm->work_cond);
 		pthread_cond_wait(&hm->exec_cond, &hm->exec_mutex);
 	}
 	pthread_mutex_unlock(&hm->exec_mutex);
@@ -12,6 +12,9 @@ struct event_pool *event_pool_create(size_t capacity)
 	if (!pool)
 		return NULL;
 	
+	atomic_init(&pool->inline_hits, 0);
+	atomic_init(&pool->spills, 0);
+	
 	pool->pool = object_pool_create(sizeof(struct nlmon_event_pooled), capacity);
 	if (!pool->pool) {
 		free(pool);
@@ -45,13 +48,57 @@ void event_pool_free(struct event_pool *pool, struct nlmon_event_pooled *event)
 	
 	/* Free event-specific data if present */
 	if (event->data) {
-		free(event->data);
+		if (event->data != (void *)event->inline_data)
+			free(event->data);
 		event->data = NULL;
 	}
 	
 	object_pool_free(pool->pool, event);
 }
 
+int event_pool_set_data(struct event_pool *pool, struct nlmon_event_pooled *event,
+                        const void *data, size_t size)
+{
+	void *copy;
+	
+	if (!pool || !event || (!data && size))
+		return -1;
+	
+	if (size == 0) {
+		event->data = NULL;
+		event->data_size = 0;
+		return 0;
+	}
+	
+	if (size <= sizeof(event->inline_data)) {
+		copy = event->inline_data;
+		atomic_fetch_add_explicit(&pool->inline_hits, 1, memory_order_relaxed);
+	} else {
+		copy = malloc(size);
+		if (!copy)
+			return -1;
+		atomic_fetch_add_explicit(&pool->spills, 1, memory_order_relaxed);
+	}
+	
+	memcpy(copy, data, size);
+	event->data = copy;
+	event->data_size = size;
+	
+	return 0;
+}
+
+void event_pool_get_data_stats(struct event_pool *pool, unsigned long *inline_hits,
+                               unsigned long *spills)
+{
+	if (!pool)
+		return;
+	
+	if (inline_hits)
+		*inline_hits = atomic_load_explicit(&pool->inline_hits, memory_order_relaxed);
+	if (spills)
+		*spills = atomic_load_explicit(&pool->spills, memory_order_relaxed);
+}
+
 void event_pool_get_stats(struct event_pool *pool, struct object_pool_stats *stats)
 {
 	if (!pool)
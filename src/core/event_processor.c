@@ -4,43 +4,166 @@
  * for high-performance parallel event processing.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #include "event_processor.h"
 #include "ring_buffer.h"
 #include "thread_pool.h"
 #include "rate_limiter.h"
+#include "object_pool.h"
+#include "thread_affinity.h"
+#include "nlmon_probes.h"
+#include "stats_bus.h"
+#include "pipeline_watchdog.h"
+
+/* Maximum number of producer lanes */
+#define EP_MAX_LANES 16
+
+/* Events a shard thread handles from one lane before moving on */
+#define EP_SHARD_BATCH 64
+
+/* Default events per dispatch task */
+#define EP_DISPATCH_BATCH 32
+
+/* Slots in the event type to priority class map */
+#define EP_PRIORITY_MAP_SIZE 256
+
+/* Slots in the per event type shedding table */
+#define EP_SHED_TYPES 256
+
+/* Overload policy defaults */
+#define EP_OVERLOAD_WATERMARK 75
+#define EP_OVERLOAD_SAMPLE_RATE 10
+#define EP_OVERLOAD_TIMEOUT_MS 10
+
+/* Dispatcher idle rounds before parking, the budget adapts within these */
+#define EP_DISPATCH_SPIN 256
+#define EP_DISPATCH_SPIN_MIN 8
+
+/* A park shorter than this means spinning longer would have paid off */
+#define EP_SHORT_PARK_NS 50000ULL
+
+/* Longest park, bounds the damage of a missed wakeup */
+#define EP_PARK_TIMEOUT_MS 100
+
+/* Producer lane - ring buffers owned by a single producer thread (MPMC for lane 0) */
+struct ep_lane {
+	struct event_processor *ep;
+	struct ring_buffer *ring_buffer;  /* Unsharded: drained by the workers */
+	pthread_mutex_t consumer_mutex;   /* Serializes workers draining the lane */
+	atomic_bool scheduled;            /* A worker task for the lane is queued */
+	struct ring_buffer **shard_rings; /* Sharded: one ring per shard */
+};
+
+/* Dispatch shard - a thread draining its ring of every lane */
+struct ep_shard {
+	struct event_processor *ep;
+	size_t index;
+	int cpu;
+	pthread_t thread;
+	atomic_ulong submitted;
+	atomic_ulong processed;
+	atomic_ulong dropped;
+	atomic_ulong evicted;             /* Routed events shed by drop-oldest */
+	char pad[64];                     /* Keep shard counters on separate cache lines */
+};
 
-/* Object pool for event structures */
-struct event_pool {
-	struct nlmon_event **objects;
-	size_t capacity;
-	atomic_size_t head;
-	atomic_size_t tail;
-	pthread_mutex_t mutex;
+/* Priority class - a ring any producer may feed */
+struct ep_priority {
+	struct ring_buffer *ring_buffer;
+	unsigned int weight;
+	size_t credit;                    /* Left of the weighted round, owned by the task */
+	atomic_ulong submitted;
+	atomic_ulong dispatched;
+	atomic_ulong dropped;
+};
+
+/* Event type to priority class map entry */
+struct ep_priority_map_entry {
+	uint32_t event_type;
+	int priority;                     /* -1 for an unused entry */
+};
+
+/* Shedding decisions counted per event type */
+enum ep_shed_counter {
+	EP_SHED_DROPPED = 0,
+	EP_SHED_EVICTED,
+	EP_SHED_SAMPLED,
+	EP_SHED_BLOCKED,
+	EP_SHED_COUNTERS
+};
+
+/* Shedding decisions for one event type */
+struct ep_shed_entry {
+	atomic_ullong key;                /* event_type + 1, 0 for an unused entry */
+	atomic_ulong seen;                /* Events considered while sampling */
+	atomic_ulong counts[EP_SHED_COUNTERS];
 };
 
 /* Event handler entry */
 struct event_handler_entry {
 	int id;
 	event_handler_t handler;
+	event_batch_handler_t batch_handler;
 	void *ctx;
-	struct event_handler_entry *next;
+};
+
+/*
+ * Registered handlers, newest first. A set is never modified once
+ * published; registration publishes a copy and frees the old set after
+ * a grace period, so workers walk it without taking a lock.
+ */
+struct ep_handler_set {
+	size_t count;
+	struct event_handler_entry entries[];
 };
 
 /* Event processor structure */
 struct event_processor {
-	struct ring_buffer *ring_buffer;
+	/* Producer lanes, lane 0 is the default lane used by submit() */
+	struct ep_lane lanes[EP_MAX_LANES];
+	atomic_int lane_count;
+	pthread_mutex_t lanes_mutex;
+	
 	struct thread_pool *thread_pool;
 	struct rate_limiter_map *rate_limiter;
-	struct event_pool *event_pool;
-	
-	/* Event handlers */
-	struct event_handler_entry *handlers;
+	struct object_pool *event_pool;
+	
+	/* Dispatch shards, shard_count is 0 when unsharded */
+	struct ep_shard shards[EVENT_PROCESSOR_MAX_SHARDS];
+	size_t shard_count;
+	
+	/* Priority classes, priority_count is 0 when disabled */
+	struct ep_priority priorities[EVENT_PROCESSOR_MAX_PRIORITIES];
+	size_t priority_count;
+	size_t priority_cursor;           /* Class the weighted round resumes at */
+	atomic_bool priority_scheduled;   /* A priority batch task is queued */
+	struct ep_priority_map_entry priority_map[EP_PRIORITY_MAP_SIZE];
+	event_classifier_t classifier;
+	void *classifier_ctx;
+	pthread_rwlock_t priority_lock;
+	
+	/* Overload shedding per event type, entries are claimed on first use */
+	struct ep_shed_entry shed[EP_SHED_TYPES];
+	
+	/* Event handlers, read under an epoch, replaced under handlers_mutex */
+	_Atomic(struct ep_handler_set *) handlers;
+	atomic_uint handler_epoch;
+	atomic_ulong handler_readers[2];  /* Workers inside each epoch parity */
 	pthread_mutex_t handlers_mutex;
 	int next_handler_id;
 	
@@ -51,6 +174,19 @@ struct event_processor {
 	atomic_bool running;
 	pthread_t dispatcher_thread;
 	
+	/* Dispatcher wakeup, wake_fd is only signalled while the dispatcher is parked */
+	int wake_fd;
+	atomic_bool parked;
+	atomic_uint spin_limit;           /* Idle rounds before parking, set by the dispatcher */
+	atomic_ullong wake_time_ns;       /* When the pending wakeup was signalled */
+	atomic_ulong idle_spins;
+	atomic_ulong parks;
+	atomic_ulong wakeups;
+	atomic_ulong woken;               /* Parks ended by a wakeup, not the timeout */
+	atomic_ullong parked_ns;
+	atomic_ullong wake_latency_ns;    /* Sum over woken */
+	atomic_ullong wake_latency_max_ns;
+	
 	/* Statistics */
 	atomic_ulong submitted_count;
 	atomic_ulong processed_count;
@@ -59,255 +195,1029 @@ struct event_processor {
 	atomic_ullong sequence_counter;
 };
 
-/* Object pool functions */
-static struct event_pool *event_pool_create(size_t capacity)
+/* Event copies come from the pool, or the heap without one */
+static struct nlmon_event *event_pool_alloc(struct object_pool *pool)
 {
-	struct event_pool *pool;
-	size_t i;
-	
-	pool = calloc(1, sizeof(*pool));
 	if (!pool)
-		return NULL;
+		return calloc(1, sizeof(struct nlmon_event));
 	
-	pool->capacity = capacity;
-	pool->objects = calloc(capacity, sizeof(struct nlmon_event *));
-	if (!pool->objects) {
-		free(pool);
-		return NULL;
+	return object_pool_alloc(pool);
+}
+
+static void event_pool_free(struct object_pool *pool, struct nlmon_event *event)
+{
+	if (!event)
+		return;
+	
+	/* Clear event data */
+	nlmon_event_free_data(event);
+	
+	if (pool)
+		object_pool_free(pool, event);
+	else
+		free(event);
+}
+
+/* Payload placement, see nlmon_event_data_stats() */
+static atomic_ulong event_data_inline;
+static atomic_ulong event_data_spilled;
+
+int nlmon_event_copy_data(struct nlmon_event *event, const void *data, size_t size)
+{
+	void *copy;
+	
+	if (!event)
+		return -1;
+	
+	if (!data || size == 0) {
+		event->data = NULL;
+		event->data_size = 0;
+		return 0;
 	}
 	
-	/* Pre-allocate event objects */
-	for (i = 0; i < capacity; i++) {
-		pool->objects[i] = calloc(1, sizeof(struct nlmon_event));
-		if (!pool->objects[i]) {
-			/* Cleanup on failure */
-			for (size_t j = 0; j < i; j++)
-				free(pool->objects[j]);
-			free(pool->objects);
-			free(pool);
-			return NULL;
-		}
+	if (size <= sizeof(event->inline_data)) {
+		copy = event->inline_data;
+		atomic_fetch_add_explicit(&event_data_inline, 1, memory_order_relaxed);
+	} else {
+		copy = malloc(size);
+		if (!copy)
+			return -1;
+		atomic_fetch_add_explicit(&event_data_spilled, 1, memory_order_relaxed);
 	}
 	
-	atomic_init(&pool->head, 0);
-	atomic_init(&pool->tail, capacity);
+	memcpy(copy, data, size);
+	event->data = copy;
+	event->data_size = size;
+	
+	/* Parsed attributes carried as the payload move with it */
+	if (event->netlink.data.generic == data)
+		event->netlink.data.generic = copy;
+	
+	return 0;
+}
+
+void nlmon_event_free_data(struct nlmon_event *event)
+{
+	if (!event || !event->data)
+		return;
+	
+	if (event->data != (void *)event->inline_data)
+		free(event->data);
+	event->data = NULL;
+	event->data_size = 0;
+}
+
+void nlmon_event_data_stats(unsigned long *inline_hits, unsigned long *spills)
+{
+	if (inline_hits)
+		*inline_hits = atomic_load_explicit(&event_data_inline, memory_order_relaxed);
+	if (spills)
+		*spills = atomic_load_explicit(&event_data_spilled, memory_order_relaxed);
+}
+
+/* Refcounted event, large payloads follow at EVENT_SHARED_PAYLOAD */
+struct nlmon_event_shared {
+	atomic_uint refcount;
+	struct nlmon_event event;
+};
+
+#define EVENT_SHARED_PAYLOAD \
+	((sizeof(struct nlmon_event_shared) + _Alignof(max_align_t) - 1) & \
+	 ~(_Alignof(max_align_t) - 1))
+
+bool nlmon_event_is_shared(const struct nlmon_event *event)
+{
+	/* Copies keep the pointer but not the address it belongs to */
+	return event && event->shared &&
+	       (uintptr_t)event->shared + offsetof(struct nlmon_event_shared, event) ==
+	       (uintptr_t)event;
+}
+
+struct nlmon_event *nlmon_event_alloc(size_t data_size)
+{
+	struct nlmon_event_shared *shared;
+	
+	bool fits = data_size <= sizeof(shared->event.inline_data);
+	
+	if (data_size > SIZE_MAX - EVENT_SHARED_PAYLOAD)
+		return NULL;
 	
-	if (pthread_mutex_init(&pool->mutex, NULL) != 0) {
-		for (i = 0; i < capacity; i++)
-			free(pool->objects[i]);
-		free(pool->objects);
-		free(pool);
+	shared = calloc(1, fits ? sizeof(*shared) : EVENT_SHARED_PAYLOAD + data_size);
+	if (!shared)
 		return NULL;
+	
+	atomic_init(&shared->refcount, 1);
+	shared->event.shared = shared;
+	if (data_size) {
+		if (fits) {
+			shared->event.data = shared->event.inline_data;
+			atomic_fetch_add_explicit(&event_data_inline, 1, memory_order_relaxed);
+		} else {
+			shared->event.data = (char *)shared + EVENT_SHARED_PAYLOAD;
+			atomic_fetch_add_explicit(&event_data_spilled, 1, memory_order_relaxed);
+		}
+		shared->event.data_size = data_size;
 	}
 	
-	return pool;
+	return &shared->event;
 }
 
-static void event_pool_destroy(struct event_pool *pool)
+/* Copy an event and its payload into a new refcounted event */
+static struct nlmon_event *event_copy_shared(const struct nlmon_event *event)
 {
-	size_t i;
+	struct nlmon_event_shared *shared;
+	struct nlmon_event *copy;
+	size_t size;
+	void *data;
+	
+	size = event->data ? event->data_size : 0;
+	copy = nlmon_event_alloc(size);
+	if (!copy)
+		return NULL;
 	
-	if (!pool)
-		return;
+	shared = copy->shared;
+	data = copy->data;
+	
+	*copy = *event;
+	copy->shared = shared;
+	copy->data = data;
+	copy->data_size = size;
+	if (size)
+		memcpy(data, event->data, size);
 	
-	for (i = 0; i < pool->capacity; i++)
-		free(pool->objects[i]);
+	/* Parsed attributes carried as the payload move with it */
+	if (event->netlink.data.generic && event->netlink.data.generic == event->data)
+		copy->netlink.data.generic = data;
 	
-	free(pool->objects);
-	pthread_mutex_destroy(&pool->mutex);
-	free(pool);
+	return copy;
 }
 
-static struct nlmon_event *event_pool_alloc(struct event_pool *pool)
+struct nlmon_event *nlmon_event_share(struct nlmon_event *event)
 {
-	struct nlmon_event *event = NULL;
-	size_t tail;
+	if (!event)
+		return NULL;
 	
-	if (!pool)
-		return calloc(1, sizeof(struct nlmon_event));
+	if (nlmon_event_is_shared(event)) {
+		atomic_fetch_add_explicit(&event->shared->refcount, 1, memory_order_relaxed);
+		return event;
+	}
+	
+	/* A pending decode does not outlive the producer's callback */
+	nlmon_event_materialize(event);
 	
-	pthread_mutex_lock(&pool->mutex);
+	return event_copy_shared(event);
+}
+
+void nlmon_event_put(struct nlmon_event *event)
+{
+	if (!nlmon_event_is_shared(event))
+		return;
 	
-	tail = atomic_load_explicit(&pool->tail, memory_order_acquire);
-	if (tail > 0) {
-		tail--;
-		event = pool->objects[tail];
-		atomic_store_explicit(&pool->tail, tail, memory_order_release);
+	if (atomic_fetch_sub_explicit(&event->shared->refcount, 1, memory_order_acq_rel) == 1)
+		free(event->shared);
+}
+
+/* Release a queued event, either a reference or a pool copy */
+static void ep_event_release(struct event_processor *ep, struct nlmon_event *event)
+{
+	if (nlmon_event_is_shared(event))
+		nlmon_event_put(event);
+	else
+		event_pool_free(ep->event_pool, event);
+}
+
+/*
+ * Enter a handler read section, returning the epoch parity to leave.
+ * The epoch is checked again once counted in, so a writer that flipped
+ * it in between is not missed: it either waits for this reader or the
+ * reader retries in the new epoch and sees the writer's handler set.
+ */
+static unsigned int ep_handlers_enter(struct event_processor *ep)
+{
+	for (;;) {
+		unsigned int epoch = atomic_load(&ep->handler_epoch);
+		
+		atomic_fetch_add(&ep->handler_readers[epoch & 1], 1);
+		if (atomic_load(&ep->handler_epoch) == epoch)
+			return epoch & 1;
+		atomic_fetch_sub(&ep->handler_readers[epoch & 1], 1);
 	}
+}
+
+static void ep_handlers_exit(struct event_processor *ep, unsigned int parity)
+{
+	atomic_fetch_sub_explicit(&ep->handler_readers[parity], 1, memory_order_release);
+}
+
+/*
+ * Wait until no worker can still see a handler set replaced before the
+ * call, called with handlers_mutex held. Readers entering from now on
+ * count in the other parity and load the new set.
+ */
+static void ep_handlers_synchronize(struct event_processor *ep)
+{
+	unsigned int epoch = atomic_fetch_add(&ep->handler_epoch, 1);
 	
-	pthread_mutex_unlock(&pool->mutex);
+	while (atomic_load(&ep->handler_readers[epoch & 1]))
+		sched_yield();
+}
+
+/* Run all registered handlers on a batch of events and release them */
+static void ep_dispatch_batch(struct event_processor *ep, struct nlmon_event **events,
+                              size_t count)
+{
+	const struct ep_handler_set *set;
+	const char *stage;
+	unsigned int parity;
+	size_t h, i;
+	
+	NLMON_PROBE1(dispatch_start, count);
+	for (i = 0; i < count; i++)
+		nlmon_trace_stamp(&events[i]->trace, NLMON_TRACE_DISPATCH);
+	
+	/* Workers and shards run handlers in parallel */
+	stage = nlmon_heartbeat_enter("handlers");
+	parity = ep_handlers_enter(ep);
+	set = atomic_load_explicit(&ep->handlers, memory_order_acquire);
+	for (h = 0; set && h < set->count; h++) {
+		const struct event_handler_entry *handler = &set->entries[h];
+		
+		if (handler->batch_handler) {
+			handler->batch_handler(events, count, handler->ctx);
+		} else if (handler->handler) {
+			for (i = 0; i < count; i++)
+				handler->handler(events[i], handler->ctx);
+		}
+	}
+	ep_handlers_exit(ep, parity);
+	nlmon_heartbeat_leave(stage);
+	NLMON_PROBE1(dispatch_done, count);
 	
-	if (!event)
-		event = calloc(1, sizeof(struct nlmon_event));
+	/* Update statistics */
+	atomic_fetch_add_explicit(&ep->processed_count, count, memory_order_relaxed);
 	
-	return event;
+	/* Return events to pool, or drop the queue's references */
+	for (i = 0; i < count; i++) {
+		nlmon_trace_finish(&events[i]->trace, NLMON_TRACE_HANDLER);
+		ep_event_release(ep, events[i]);
+	}
 }
 
-static void event_pool_free(struct event_pool *pool, struct nlmon_event *event)
+/* Worker function for processing a batch of events from one lane */
+static uint64_t ep_now_ns(void)
 {
-	size_t tail;
+	struct timespec ts;
 	
-	if (!event)
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline void ep_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	atomic_signal_fence(memory_order_seq_cst);
+#endif
+}
+
+/*
+ * Wake the dispatcher after queueing work for it. Pairs with the flag
+ * store and recheck in ep_dispatcher_park(), so only the first producer
+ * to find it parked pays for the system call.
+ */
+static void ep_wake(struct event_processor *ep)
+{
+	uint64_t one = 1;
+	
+	if (ep->wake_fd < 0)
 		return;
 	
-	if (!pool) {
-		free(event);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!atomic_load_explicit(&ep->parked, memory_order_relaxed) ||
+	    !atomic_exchange_explicit(&ep->parked, false, memory_order_acq_rel))
 		return;
+	
+	atomic_store_explicit(&ep->wake_time_ns, ep_now_ns(), memory_order_relaxed);
+	atomic_fetch_add_explicit(&ep->wakeups, 1, memory_order_relaxed);
+	if (write(ep->wake_fd, &one, sizeof(one)) < 0) {
+		/* Counter saturated, the dispatcher is awake anyway */
+	}
+}
+
+static void process_event_work(void *arg)
+{
+	struct ep_lane *lane = arg;
+	struct nlmon_event *events[EVENT_PROCESSOR_MAX_BATCH];
+	size_t count;
+	
+	/* Dequeue from the lane (ring buffers are single-consumer) */
+	pthread_mutex_lock(&lane->consumer_mutex);
+	count = ring_buffer_dequeue_bulk(lane->ring_buffer, (void **)events,
+	                                  lane->ep->config.dispatch_batch);
+	pthread_mutex_unlock(&lane->consumer_mutex);
+	
+	if (count)
+		ep_dispatch_batch(lane->ep, events, count);
+	
+	/* Let the dispatcher schedule the next batch, keeps the lane in order */
+	atomic_store_explicit(&lane->scheduled, false, memory_order_release);
+	if (!ring_buffer_is_empty(lane->ring_buffer))
+		ep_wake(lane->ep);
+}
+
+/* Fill a batch from the priority classes in policy order */
+static size_t ep_priority_dequeue(struct event_processor *ep, struct nlmon_event **events,
+                                  size_t max)
+{
+	size_t count = 0;
+	size_t i, n, want, idle;
+	
+	if (ep->config.priority_policy != EVENT_PRIORITY_WEIGHTED) {
+		/* Strict, less urgent classes only fill what is left */
+		for (i = 0; i < ep->priority_count && count < max; i++) {
+			n = ring_buffer_dequeue_bulk(ep->priorities[i].ring_buffer,
+			                             (void **)events + count, max - count);
+			atomic_fetch_add_explicit(&ep->priorities[i].dispatched, n,
+			                          memory_order_relaxed);
+			count += n;
+		}
+		
+		return count;
 	}
 	
-	/* Clear event data */
-	if (event->data) {
-		free(event->data);
-		event->data = NULL;
+	/* Weighted rounds, a class that runs empty forfeits its remaining credit */
+	i = ep->priority_cursor;
+	idle = 0;
+	while (count < max && idle < ep->priority_count) {
+		struct ep_priority *prio = &ep->priorities[i];
+		
+		if (prio->credit == 0)
+			prio->credit = prio->weight;
+		
+		want = prio->credit < max - count ? prio->credit : max - count;
+		n = ring_buffer_dequeue_bulk(prio->ring_buffer, (void **)events + count, want);
+		atomic_fetch_add_explicit(&prio->dispatched, n, memory_order_relaxed);
+		count += n;
+		
+		prio->credit = n < want ? 0 : prio->credit - n;
+		idle = n ? 0 : idle + 1;
+		
+		/* Stay on a class with credit left, the batch is full */
+		if (prio->credit == 0)
+			i = (i + 1) % ep->priority_count;
 	}
-	memset(event, 0, sizeof(*event));
+	ep->priority_cursor = i;
 	
-	pthread_mutex_lock(&pool->mutex);
+	return count;
+}
+
+/* Worker function for processing a batch drawn from the priority classes */
+/* True if any priority class has events queued */
+static bool ep_priority_pending(struct event_processor *ep)
+{
+	size_t i;
 	
-	tail = atomic_load_explicit(&pool->tail, memory_order_acquire);
-	if (tail < pool->capacity) {
-		pool->objects[tail] = event;
-		tail++;
-		atomic_store_explicit(&pool->tail, tail, memory_order_release);
-	} else {
-		/* Pool full, just free it */
-		free(event);
+	for (i = 0; i < ep->priority_count; i++) {
+		if (!ring_buffer_is_empty(ep->priorities[i].ring_buffer))
+			return true;
 	}
 	
-	pthread_mutex_unlock(&pool->mutex);
+	return false;
 }
 
-static size_t event_pool_usage(struct event_pool *pool)
+static void process_priority_work(void *arg)
 {
-	size_t tail;
+	struct event_processor *ep = arg;
+	struct nlmon_event *events[EVENT_PROCESSOR_MAX_BATCH];
+	size_t count;
 	
-	if (!pool)
-		return 0;
+	/* One priority task is queued at a time, it owns the class credits */
+	count = ep_priority_dequeue(ep, events, ep->config.dispatch_batch);
+	if (count)
+		ep_dispatch_batch(ep, events, count);
 	
-	tail = atomic_load_explicit(&pool->tail, memory_order_acquire);
-	return pool->capacity - tail;
+	atomic_store_explicit(&ep->priority_scheduled, false, memory_order_release);
+	if (ep_priority_pending(ep))
+		ep_wake(ep);
 }
 
-/* Worker function for processing events */
-static void process_event_work(void *arg)
+/* Thread name prefix */
+static const char *ep_thread_name(struct event_processor *ep)
 {
-	struct event_processor *ep = arg;
-	struct nlmon_event *event;
-	struct event_handler_entry *handler;
+	return ep->config.thread_name ? ep->config.thread_name : "ep";
+}
+
+/* Shard thread - handles the events routed to its shard on every lane */
+static void *shard_thread_func(void *arg)
+{
+	struct ep_shard *shard = arg;
+	struct event_processor *ep = shard->ep;
+	struct nlmon_event *events[EP_SHARD_BATCH];
+	char name[32];
+	bool idle;
+	int i, count;
+	size_t n;
 	
-	/* Dequeue event from ring buffer */
-	event = ring_buffer_dequeue(ep->ring_buffer);
-	if (!event)
-		return;
+	snprintf(name, sizeof(name), "%s-shard-%zu", ep_thread_name(ep), shard->index);
+	nlmon_heartbeat_register(name, NULL, NULL);
 	
-	/* Call all registered handlers */
-	pthread_mutex_lock(&ep->handlers_mutex);
-	for (handler = ep->handlers; handler; handler = handler->next) {
-		if (handler->handler)
-			handler->handler(event, handler->ctx);
+	while (atomic_load_explicit(&ep->running, memory_order_acquire)) {
+		idle = true;
+		count = atomic_load_explicit(&ep->lane_count, memory_order_acquire);
+		
+		/* Bounded batches so a busy lane cannot starve the rest */
+		for (i = 0; i < count; i++) {
+			struct ring_buffer *rb = ep->lanes[i].shard_rings[shard->index];
+			
+			n = ring_buffer_dequeue_bulk(rb, (void **)events, EP_SHARD_BATCH);
+			if (!n)
+				continue;
+			
+			ep_dispatch_batch(ep, events, n);
+			atomic_fetch_add_explicit(&shard->processed, n, memory_order_relaxed);
+			idle = false;
+		}
+		
+		/* No events, sleep briefly */
+		if (idle)
+			usleep(100);
 	}
-	pthread_mutex_unlock(&ep->handlers_mutex);
 	
-	/* Update statistics */
-	atomic_fetch_add_explicit(&ep->processed_count, 1, memory_order_relaxed);
+	nlmon_heartbeat_unregister();
+	return NULL;
+}
+
+/* Route an event to a shard, FNV-1a over the interface name */
+static size_t ep_shard_route(struct event_processor *ep, const struct nlmon_event *event)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+	
+	for (i = 0; i < sizeof(event->interface) && event->interface[i]; i++) {
+		hash ^= (unsigned char)event->interface[i];
+		hash *= 16777619u;
+	}
+	
+	return hash % ep->shard_count;
+}
+
+/* True if some queued work is not handed to the thread pool yet */
+static bool ep_dispatch_ready(struct event_processor *ep)
+{
+	int i, count;
+	
+	if (!atomic_load_explicit(&ep->priority_scheduled, memory_order_acquire) &&
+	    ep_priority_pending(ep))
+		return true;
+	
+	count = atomic_load_explicit(&ep->lane_count, memory_order_acquire);
+	for (i = 0; i < count; i++) {
+		if (!atomic_load_explicit(&ep->lanes[i].scheduled, memory_order_acquire) &&
+		    !ring_buffer_is_empty(ep->lanes[i].ring_buffer))
+			return true;
+	}
+	
+	return false;
+}
+
+/* Sleep until a producer or worker signals new work, or the park times out */
+static void ep_dispatcher_park(struct event_processor *ep)
+{
+	struct pollfd pfd = { .fd = ep->wake_fd, .events = POLLIN };
+	uint64_t value, start, now, signalled, latency, max;
+	unsigned int limit;
+	
+	atomic_store_explicit(&ep->parked, true, memory_order_seq_cst);
+	atomic_thread_fence(memory_order_seq_cst);
+	
+	/* Recheck, work queued before the flag was visible sends no wakeup */
+	if (ep_dispatch_ready(ep) ||
+	    !atomic_load_explicit(&ep->running, memory_order_acquire)) {
+		atomic_store_explicit(&ep->parked, false, memory_order_relaxed);
+		return;
+	}
+	
+	atomic_fetch_add_explicit(&ep->parks, 1, memory_order_relaxed);
+	start = ep_now_ns();
+	poll(&pfd, 1, EP_PARK_TIMEOUT_MS);
+	now = ep_now_ns();
+	atomic_store_explicit(&ep->parked, false, memory_order_relaxed);
+	atomic_fetch_add_explicit(&ep->parked_ns, now - start, memory_order_relaxed);
+	
+	if (read(ep->wake_fd, &value, sizeof(value)) == sizeof(value)) {
+		signalled = atomic_load_explicit(&ep->wake_time_ns, memory_order_relaxed);
+		latency = now > signalled ? now - signalled : 0;
+		
+		atomic_fetch_add_explicit(&ep->woken, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&ep->wake_latency_ns, latency, memory_order_relaxed);
+		max = atomic_load_explicit(&ep->wake_latency_max_ns, memory_order_relaxed);
+		if (latency > max)
+			atomic_store_explicit(&ep->wake_latency_max_ns, latency, memory_order_relaxed);
+	}
 	
-	/* Return event to pool */
-	event_pool_free(ep->event_pool, event);
+	/* Short parks cost a wakeup spinning would have saved, long ones burn less */
+	limit = atomic_load_explicit(&ep->spin_limit, memory_order_relaxed);
+	if (now - start < EP_SHORT_PARK_NS) {
+		limit *= 2;
+		if (limit > ep->config.dispatcher_spin)
+			limit = ep->config.dispatcher_spin;
+	} else {
+		limit /= 2;
+		if (limit < EP_DISPATCH_SPIN_MIN)
+			limit = EP_DISPATCH_SPIN_MIN;
+	}
+	atomic_store_explicit(&ep->spin_limit, limit, memory_order_relaxed);
 }
 
 /* Dispatcher thread - moves events from ring buffer to thread pool */
 static void *dispatcher_thread_func(void *arg)
 {
 	struct event_processor *ep = arg;
+	unsigned int spins = 0;
+	char name[32];
+	bool dispatched;
+	int i, count;
+	
+	snprintf(name, sizeof(name), "%s-dispatch", ep_thread_name(ep));
+	nlmon_heartbeat_register(name, NULL, NULL);
 	
 	while (atomic_load_explicit(&ep->running, memory_order_acquire)) {
-		/* Check if there are events in the ring buffer */
-		if (!ring_buffer_is_empty(ep->ring_buffer)) {
+		nlmon_heartbeat_enter("dispatch");
+		dispatched = false;
+		count = atomic_load_explicit(&ep->lane_count, memory_order_acquire);
+		
+		/* Priority classes go to the thread pool ahead of other work */
+		if (ep_priority_pending(ep) &&
+		    !atomic_exchange_explicit(&ep->priority_scheduled, true,
+		                              memory_order_acq_rel)) {
+			if (!thread_pool_submit(ep->thread_pool, process_priority_work,
+			                        ep, PRIORITY_HIGH)) {
+				atomic_store_explicit(&ep->priority_scheduled, false,
+				                      memory_order_release);
+				
+				/* Thread pool queue full, wait a bit */
+				usleep(1000);
+				continue;
+			}
+			dispatched = true;
+		}
+		
+		/* Visit lanes round-robin so a busy producer cannot starve the rest */
+		for (i = 0; i < count; i++) {
+			struct ep_lane *lane = &ep->lanes[i];
+			
+			if (ring_buffer_is_empty(lane->ring_buffer))
+				continue;
+			
+			/* One batch task per lane at a time, it drains in order */
+			if (atomic_exchange_explicit(&lane->scheduled, true, memory_order_acq_rel))
+				continue;
+			
 			/* Submit work to thread pool */
 			if (!thread_pool_submit(ep->thread_pool, process_event_work,
-			                       ep, PRIORITY_NORMAL)) {
+			                       lane, PRIORITY_NORMAL)) {
+				atomic_store_explicit(&lane->scheduled, false, memory_order_release);
+				
 				/* Thread pool queue full, wait a bit */
 				usleep(1000);
+				break;
 			}
-		} else {
-			/* No events, sleep briefly */
-			usleep(100);
+			dispatched = true;
 		}
+		
+		if (dispatched) {
+			spins = 0;
+			continue;
+		}
+		
+		/* Nothing to hand out, spin a while then park until signalled */
+		if (spins < atomic_load_explicit(&ep->spin_limit, memory_order_relaxed)) {
+			spins++;
+			atomic_fetch_add_explicit(&ep->idle_spins, 1, memory_order_relaxed);
+			ep_cpu_relax();
+			continue;
+		}
+		
+		nlmon_heartbeat_leave(NULL);
+		ep_dispatcher_park(ep);
+		spins = 0;
 	}
 	
+	nlmon_heartbeat_unregister();
+	
 	return NULL;
 }
 
-struct event_processor *event_processor_create(struct event_processor_config *config)
+/* Create the wakeup eventfd and start the dispatcher thread */
+static int ep_start_dispatcher(struct event_processor *ep)
 {
-	struct event_processor *ep;
+	ep->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (ep->wake_fd < 0)
+		return -1;
 	
-	if (!config)
-		return NULL;
+	if (pthread_create(&ep->dispatcher_thread, NULL, dispatcher_thread_func, ep) != 0) {
+		close(ep->wake_fd);
+		ep->wake_fd = -1;
+		return -1;
+	}
 	
-	ep = calloc(1, sizeof(*ep));
-	if (!ep)
-		return NULL;
+	return 0;
+}
+
+/* Stop the dispatcher thread, a parked dispatcher is woken right away */
+static void ep_stop_dispatcher(struct event_processor *ep)
+{
+	uint64_t one = 1;
 	
-	ep->config = *config;
+	atomic_store_explicit(&ep->running, false, memory_order_release);
+	if (write(ep->wake_fd, &one, sizeof(one)) < 0) {
+		/* The park timeout still ends the wait */
+	}
+	pthread_join(ep->dispatcher_thread, NULL);
 	
-	/* Set defaults */
-	if (ep->config.ring_buffer_size == 0)
-		ep->config.ring_buffer_size = 10000;
-	if (ep->config.rate_burst == 0)
-		ep->config.rate_burst = 100;
-	if (ep->config.object_pool_size == 0)
-		ep->config.object_pool_size = 1000;
+	close(ep->wake_fd);
+	ep->wake_fd = -1;
+}
+
+/* Drain and free a lane ring buffer */
+static void ep_ring_destroy(struct event_processor *ep, struct ring_buffer *rb)
+{
+	struct nlmon_event *event;
 	
-	/* Create ring buffer */
-	ep->ring_buffer = ring_buffer_create(ep->config.ring_buffer_size);
-	if (!ep->ring_buffer) {
-		free(ep);
-		return NULL;
-	}
+	if (!rb)
+		return;
 	
-	/* Create thread pool */
-	ep->thread_pool = thread_pool_create(ep->config.thread_pool_size,
-	                                     ep->config.work_queue_size);
-	if (!ep->thread_pool) {
-		ring_buffer_destroy(ep->ring_buffer);
-		free(ep);
-		return NULL;
-	}
+	while ((event = ring_buffer_dequeue(rb)) != NULL)
+		ep_event_release(ep, event);
 	
-	/* Create rate limiter if enabled */
-	if (ep->config.rate_limit > 0) {
-		ep->rate_limiter = rate_limiter_map_create(ep->config.rate_limit,
-		                                           ep->config.rate_burst);
-		if (!ep->rate_limiter) {
-			thread_pool_destroy(ep->thread_pool, false);
-			ring_buffer_destroy(ep->ring_buffer);
-			free(ep);
-			return NULL;
+	ring_buffer_destroy(rb);
+}
+
+/* Set up a producer lane, caller holds lanes_mutex or is the creator */
+static int ep_lane_init(struct event_processor *ep, struct ep_lane *lane,
+                        size_t capacity, bool multi_producer)
+{
+	struct ring_buffer *(*create)(size_t) =
+		multi_producer ? ring_buffer_create_mpmc : ring_buffer_create;
+	size_t i;
+	
+	lane->ep = ep;
+	
+	if (ep->shard_count) {
+		lane->shard_rings = calloc(ep->shard_count, sizeof(*lane->shard_rings));
+		if (!lane->shard_rings)
+			return -1;
+		
+		for (i = 0; i < ep->shard_count; i++) {
+			lane->shard_rings[i] = create(capacity);
+			if (!lane->shard_rings[i]) {
+				while (i-- > 0)
+					ring_buffer_destroy(lane->shard_rings[i]);
+				free(lane->shard_rings);
+				lane->shard_rings = NULL;
+				return -1;
+			}
 		}
+		
+		return 0;
 	}
 	
-	/* Create object pool if enabled */
-	if (ep->config.enable_object_pool) {
-		ep->event_pool = event_pool_create(ep->config.object_pool_size);
-		if (!ep->event_pool) {
-			if (ep->rate_limiter)
-				rate_limiter_map_destroy(ep->rate_limiter);
+	lane->ring_buffer = create(capacity);
+	if (!lane->ring_buffer)
+		return -1;
+	
+	atomic_init(&lane->scheduled, false);
+	
+	if (pthread_mutex_init(&lane->consumer_mutex, NULL) != 0) {
+		ring_buffer_destroy(lane->ring_buffer);
+		lane->ring_buffer = NULL;
+		return -1;
+	}
+	
+	return 0;
+}
+
+static void ep_lane_destroy(struct event_processor *ep, struct ep_lane *lane)
+{
+	size_t i;
+	
+	if (lane->shard_rings) {
+		for (i = 0; i < ep->shard_count; i++)
+			ep_ring_destroy(ep, lane->shard_rings[i]);
+		free(lane->shard_rings);
+		lane->shard_rings = NULL;
+	}
+	
+	if (!lane->ring_buffer)
+		return;
+	
+	ep_ring_destroy(ep, lane->ring_buffer);
+	pthread_mutex_destroy(&lane->consumer_mutex);
+	lane->ring_buffer = NULL;
+}
+
+/* Set up the priority classes and the event type map */
+static int ep_priorities_init(struct event_processor *ep)
+{
+	size_t i;
+	
+	ep->priority_count = ep->config.priority_classes;
+	if (!ep->priority_count)
+		return 0;
+	
+	for (i = 0; i < EP_PRIORITY_MAP_SIZE; i++)
+		ep->priority_map[i].priority = -1;
+	
+	if (pthread_rwlock_init(&ep->priority_lock, NULL) != 0) {
+		ep->priority_count = 0;
+		return -1;
+	}
+	
+	for (i = 0; i < ep->priority_count; i++) {
+		struct ep_priority *prio = &ep->priorities[i];
+		size_t capacity = ep->config.priority[i].capacity;
+		
+		prio->ring_buffer = ring_buffer_create_mpmc(capacity ? capacity :
+		                                            ep->config.ring_buffer_size);
+		if (!prio->ring_buffer) {
+			while (i-- > 0)
+				ring_buffer_destroy(ep->priorities[i].ring_buffer);
+			pthread_rwlock_destroy(&ep->priority_lock);
+			ep->priority_count = 0;
+			return -1;
+		}
+		
+		prio->weight = ep->config.priority[i].weight ? ep->config.priority[i].weight : 1;
+		atomic_init(&prio->submitted, 0);
+		atomic_init(&prio->dispatched, 0);
+		atomic_init(&prio->dropped, 0);
+	}
+	
+	atomic_init(&ep->priority_scheduled, false);
+	
+	return 0;
+}
+
+static void ep_priorities_destroy(struct event_processor *ep)
+{
+	size_t i;
+	
+	if (!ep->priority_count)
+		return;
+	
+	for (i = 0; i < ep->priority_count; i++)
+		ep_ring_destroy(ep, ep->priorities[i].ring_buffer);
+	pthread_rwlock_destroy(&ep->priority_lock);
+	ep->priority_count = 0;
+}
+
+/* Stop and join the first count shard threads */
+static void ep_stop_shards(struct event_processor *ep, size_t count)
+{
+	size_t i;
+	
+	atomic_store_explicit(&ep->running, false, memory_order_release);
+	for (i = 0; i < count; i++)
+		pthread_join(ep->shards[i].thread, NULL);
+}
+
+/* Start one thread per shard, pinned to worker_cpus or the allowed CPUs in turn */
+static int ep_start_shards(struct event_processor *ep)
+{
+	cpu_set_t allowed;
+	int cpus[CPU_SETSIZE];
+	int ncpus = 0;
+	size_t i;
+	int c;
+	
+	if (!ep->config.worker_cpus &&
+	    sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+		for (c = 0; c < CPU_SETSIZE; c++) {
+			if (CPU_ISSET(c, &allowed))
+				cpus[ncpus++] = c;
+		}
+	}
+	
+	for (i = 0; i < ep->shard_count; i++) {
+		struct ep_shard *shard = &ep->shards[i];
+		char name[32];
+		
+		shard->ep = ep;
+		shard->index = i;
+		shard->cpu = -1;
+		atomic_init(&shard->submitted, 0);
+		atomic_init(&shard->processed, 0);
+		atomic_init(&shard->dropped, 0);
+		atomic_init(&shard->evicted, 0);
+		
+		if (pthread_create(&shard->thread, NULL, shard_thread_func, shard) != 0) {
+			ep_stop_shards(ep, i);
+			return -1;
+		}
+		
+		snprintf(name, sizeof(name), "%s-shard-%zu", ep_thread_name(ep), i);
+		thread_affinity_apply(shard->thread, NULL, -1, name);
+		
+		/* Pinning is best effort, an unpinned shard still works */
+		if (ep->config.worker_cpus) {
+			shard->cpu = thread_affinity_apply(shard->thread, ep->config.worker_cpus,
+			                                   (int)i, NULL);
+		} else if (ncpus > 0) {
+			cpu_set_t set;
+			
+			CPU_ZERO(&set);
+			CPU_SET(cpus[i % ncpus], &set);
+			if (pthread_setaffinity_np(shard->thread, sizeof(set), &set) == 0)
+				shard->cpu = cpus[i % ncpus];
+		}
+	}
+	
+	return 0;
+}
+
+/* Burst of a limit configured as events per second only */
+static size_t ep_rate_burst(double rate)
+{
+	return rate < 1 ? 1 : (size_t)(rate + 0.5);
+}
+
+/* Rate limiter map with every level the configuration asks for */
+static struct rate_limiter_map *ep_rate_limiter_create(const struct event_processor_config *config)
+{
+	struct rate_limiter_map *map;
+	bool ok = true;
+	
+	map = rate_limiter_map_create(config->rate_limit, config->rate_burst);
+	if (!map)
+		return NULL;
+	
+	if (config->rate_limit_keys)
+		ok = rate_limiter_map_set_key_capacity(map, config->rate_limit_keys);
+	if (ok && config->total_rate_limit > 0)
+		ok = rate_limiter_map_set_global(map, config->total_rate_limit,
+		                                 config->rate_burst ? config->rate_burst :
+		                                 ep_rate_burst(config->total_rate_limit));
+	if (ok && config->interface_rate_limit > 0)
+		ok = rate_limiter_map_set_key_limit(map, RATE_LIMITER_KEY_INTERFACE,
+		                                    config->interface_rate_limit,
+		                                    ep_rate_burst(config->interface_rate_limit));
+	if (ok && config->genl_family_rate_limit > 0)
+		ok = rate_limiter_map_set_key_limit(map, RATE_LIMITER_KEY_GENL_FAMILY,
+		                                    config->genl_family_rate_limit,
+		                                    ep_rate_burst(config->genl_family_rate_limit));
+	
+	if (!ok) {
+		rate_limiter_map_destroy(map);
+		return NULL;
+	}
+	
+	return map;
+}
+
+static struct event_processor *ep_create(struct event_processor_config *config)
+{
+	struct event_processor *ep;
+	char name[32];
+	
+	if (!config)
+		return NULL;
+	
+	ep = calloc(1, sizeof(*ep));
+	if (!ep)
+		return NULL;
+	
+	ep->config = *config;
+	
+	/* Set defaults */
+	if (ep->config.ring_buffer_size == 0)
+		ep->config.ring_buffer_size = 10000;
+	if (ep->config.rate_burst == 0)
+		ep->config.rate_burst = 100;
+	if (ep->config.object_pool_size == 0)
+		ep->config.object_pool_size = 1000;
+	if (ep->config.dispatch_batch == 0)
+		ep->config.dispatch_batch = EP_DISPATCH_BATCH;
+	if (ep->config.dispatch_batch > EVENT_PROCESSOR_MAX_BATCH)
+		ep->config.dispatch_batch = EVENT_PROCESSOR_MAX_BATCH;
+	if (ep->config.dispatcher_spin == 0)
+		ep->config.dispatcher_spin = EP_DISPATCH_SPIN;
+	atomic_init(&ep->spin_limit, ep->config.dispatcher_spin);
+	ep->wake_fd = -1;
+	
+	/* Resolve the shard count before any lane is set up */
+	if (ep->config.shard_count == EVENT_PROCESSOR_SHARDS_PER_CPU) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		
+		ep->config.shard_count = ncpu > 0 ? (size_t)ncpu : 1;
+	}
+	if (ep->config.shard_count > EVENT_PROCESSOR_MAX_SHARDS)
+		ep->config.shard_count = EVENT_PROCESSOR_MAX_SHARDS;
+	ep->shard_count = ep->config.shard_count;
+	
+	/* Shard threads drain their own rings, priority classes need the dispatcher */
+	if (ep->shard_count)
+		ep->config.priority_classes = 0;
+	if (ep->config.priority_classes > EVENT_PROCESSOR_MAX_PRIORITIES)
+		ep->config.priority_classes = EVENT_PROCESSOR_MAX_PRIORITIES;
+	if (ep->config.priority_classes &&
+	    ep->config.default_priority >= ep->config.priority_classes)
+		ep->config.default_priority = ep->config.priority_classes - 1;
+	
+	if (ep->config.overload_watermark == 0 || ep->config.overload_watermark > 100)
+		ep->config.overload_watermark = EP_OVERLOAD_WATERMARK;
+	if (ep->config.overload_sample_rate == 0)
+		ep->config.overload_sample_rate = EP_OVERLOAD_SAMPLE_RATE;
+	if (ep->config.overload_timeout_ms == 0)
+		ep->config.overload_timeout_ms = EP_OVERLOAD_TIMEOUT_MS;
+	
+	/* Create the default lane, any thread may submit to it */
+	if (ep_lane_init(ep, &ep->lanes[0], ep->config.ring_buffer_size, true) < 0) {
+		free(ep);
+		return NULL;
+	}
+	atomic_init(&ep->lane_count, 1);
+	
+	if (pthread_mutex_init(&ep->lanes_mutex, NULL) != 0) {
+		ep_lane_destroy(ep, &ep->lanes[0]);
+		free(ep);
+		return NULL;
+	}
+	
+	if (ep_priorities_init(ep) < 0) {
+		pthread_mutex_destroy(&ep->lanes_mutex);
+		ep_lane_destroy(ep, &ep->lanes[0]);
+		free(ep);
+		return NULL;
+	}
+	
+	/* Create thread pool, shards run handlers on their own threads */
+	if (!ep->shard_count) {
+		struct thread_pool_options pool_opts = {
+			.num_threads = ep->config.thread_pool_size,
+			.queue_size = ep->config.work_queue_size,
+			.mode = ep->config.work_stealing ? THREAD_POOL_WORK_STEALING :
+			                                   THREAD_POOL_SHARED_QUEUE,
+			.cpus = ep->config.worker_cpus,
+			.name = name,
+			.min_threads = ep->config.thread_pool_min,
+			.max_threads = ep->config.thread_pool_max,
+			.target_wait_us = ep->config.thread_pool_wait_us,
+		};
+		
+		snprintf(name, sizeof(name), "%s-worker", ep_thread_name(ep));
+		ep->thread_pool = thread_pool_create_opts(&pool_opts);
+	}
+	if (!ep->shard_count && !ep->thread_pool) {
+		ep_priorities_destroy(ep);
+		pthread_mutex_destroy(&ep->lanes_mutex);
+		ep_lane_destroy(ep, &ep->lanes[0]);
+		free(ep);
+		return NULL;
+	}
+	
+	/* Create rate limiter if enabled */
+	if (ep->config.rate_limit > 0 || ep->config.total_rate_limit > 0 ||
+	    ep->config.interface_rate_limit > 0 || ep->config.genl_family_rate_limit > 0) {
+		ep->rate_limiter = ep_rate_limiter_create(&ep->config);
+		if (!ep->rate_limiter) {
 			thread_pool_destroy(ep->thread_pool, false);
-			ring_buffer_destroy(ep->ring_buffer);
+			ep_priorities_destroy(ep);
+			pthread_mutex_destroy(&ep->lanes_mutex);
+			ep_lane_destroy(ep, &ep->lanes[0]);
 			free(ep);
 			return NULL;
 		}
 	}
 	
-	/* Initialize handlers mutex */
+	/* Create object pool if enabled */
+	if (ep->config.enable_object_pool) {
+		ep->event_pool = object_pool_create(sizeof(struct nlmon_event),
+		                                     ep->config.object_pool_size);
+		if (!ep->event_pool) {
+			if (ep->rate_limiter)
+				rate_limiter_map_destroy(ep->rate_limiter);
+			thread_pool_destroy(ep->thread_pool, false);
+			ep_priorities_destroy(ep);
+			pthread_mutex_destroy(&ep->lanes_mutex);
+			ep_lane_destroy(ep, &ep->lanes[0]);
+			free(ep);
+			return NULL;
+		}
+	}
+	
+	/* Initialize handlers lock */
 	if (pthread_mutex_init(&ep->handlers_mutex, NULL) != 0) {
 		if (ep->event_pool)
-			event_pool_destroy(ep->event_pool);
+			object_pool_destroy(ep->event_pool);
 		if (ep->rate_limiter)
 			rate_limiter_map_destroy(ep->rate_limiter);
 		thread_pool_destroy(ep->thread_pool, false);
-		ring_buffer_destroy(ep->ring_buffer);
+		ep_priorities_destroy(ep);
+		pthread_mutex_destroy(&ep->lanes_mutex);
+		ep_lane_destroy(ep, &ep->lanes[0]);
 		free(ep);
 		return NULL;
 	}
@@ -320,34 +1230,70 @@ struct event_processor *event_processor_create(struct event_processor_config *co
 	atomic_init(&ep->rate_limited_count, 0);
 	atomic_init(&ep->sequence_counter, 0);
 	
+	atomic_init(&ep->handlers, NULL);
+	atomic_init(&ep->handler_epoch, 0);
+	atomic_init(&ep->handler_readers[0], 0);
+	atomic_init(&ep->handler_readers[1], 0);
 	ep->next_handler_id = 1;
 	
-	/* Start dispatcher thread */
-	if (pthread_create(&ep->dispatcher_thread, NULL, dispatcher_thread_func, ep) != 0) {
+	/* Start shard threads or the dispatcher thread */
+	if (ep->shard_count ? ep_start_shards(ep) < 0 : ep_start_dispatcher(ep) < 0) {
 		pthread_mutex_destroy(&ep->handlers_mutex);
 		if (ep->event_pool)
-			event_pool_destroy(ep->event_pool);
+			object_pool_destroy(ep->event_pool);
 		if (ep->rate_limiter)
 			rate_limiter_map_destroy(ep->rate_limiter);
 		thread_pool_destroy(ep->thread_pool, false);
-		ring_buffer_destroy(ep->ring_buffer);
+		ep_priorities_destroy(ep);
+		pthread_mutex_destroy(&ep->lanes_mutex);
+		ep_lane_destroy(ep, &ep->lanes[0]);
 		free(ep);
 		return NULL;
 	}
 	
+	if (!ep->shard_count) {
+		snprintf(name, sizeof(name), "%s-dispatch", ep_thread_name(ep));
+		thread_affinity_apply(ep->dispatcher_thread, ep->config.dispatcher_cpus, -1, name);
+	}
+	
+	return ep;
+}
+
+struct event_processor *event_processor_create(struct event_processor_config *config)
+{
+	struct thread_mempolicy policy = { .valid = false };
+	struct event_processor *ep;
+	int node = -1;
+	
+	/* Rings and pools are allocated where their consumers run */
+	if (config)
+		node = thread_affinity_node(config->worker_cpus ? config->worker_cpus :
+		                            config->dispatcher_cpus);
+	if (node >= 0)
+		thread_affinity_prefer_node(node, &policy);
+	
+	ep = ep_create(config);
+	
+	thread_affinity_restore(&policy);
 	return ep;
 }
 
 void event_processor_destroy(struct event_processor *ep, bool wait)
 {
-	struct event_handler_entry *handler, *next;
+	int i, count;
 	
 	if (!ep)
 		return;
 	
-	/* Stop dispatcher */
-	atomic_store_explicit(&ep->running, false, memory_order_release);
-	pthread_join(ep->dispatcher_thread, NULL);
+	if (ep->shard_count) {
+		/* Shards handle what is queued before they are stopped */
+		if (wait)
+			event_processor_wait(ep);
+		ep_stop_shards(ep, ep->shard_count);
+	} else {
+		/* Stop dispatcher */
+		ep_stop_dispatcher(ep);
+	}
 	
 	/* Wait for pending work if requested */
 	if (wait) {
@@ -357,128 +1303,531 @@ void event_processor_destroy(struct event_processor *ep, bool wait)
 	/* Cleanup */
 	thread_pool_destroy(ep->thread_pool, wait);
 	
-	/* Drain ring buffer */
-	while (!ring_buffer_is_empty(ep->ring_buffer)) {
-		struct nlmon_event *event = ring_buffer_dequeue(ep->ring_buffer);
-		event_pool_free(ep->event_pool, event);
-	}
-	
-	ring_buffer_destroy(ep->ring_buffer);
+	/* Drain and free all lanes and priority classes */
+	count = atomic_load_explicit(&ep->lane_count, memory_order_acquire);
+	for (i = 0; i < count; i++)
+		ep_lane_destroy(ep, &ep->lanes[i]);
+	pthread_mutex_destroy(&ep->lanes_mutex);
+	ep_priorities_destroy(ep);
 	
 	if (ep->rate_limiter)
 		rate_limiter_map_destroy(ep->rate_limiter);
 	
 	if (ep->event_pool)
-		event_pool_destroy(ep->event_pool);
-	
-	/* Free handlers */
-	handler = ep->handlers;
-	while (handler) {
-		next = handler->next;
-		free(handler);
-		handler = next;
-	}
+		object_pool_destroy(ep->event_pool);
 	
+	/* No worker is left to read the handlers */
+	free(atomic_load_explicit(&ep->handlers, memory_order_relaxed));
 	pthread_mutex_destroy(&ep->handlers_mutex);
 	free(ep);
 }
 
-int event_processor_register_handler(struct event_processor *ep,
-                                     event_handler_t handler, void *ctx)
+/* Publish @set in place of the current handlers and free those once unseen */
+static void ep_replace_handlers(struct event_processor *ep, struct ep_handler_set *set)
+{
+	struct ep_handler_set *old;
+	
+	old = atomic_exchange_explicit(&ep->handlers, set, memory_order_acq_rel);
+	ep_handlers_synchronize(ep);
+	free(old);
+}
+
+static int ep_add_handler(struct event_processor *ep, event_handler_t handler,
+                          event_batch_handler_t batch_handler, void *ctx)
 {
-	struct event_handler_entry *entry;
+	const struct ep_handler_set *old;
+	struct ep_handler_set *set;
+	size_t count;
 	int id;
 	
-	if (!ep || !handler)
-		return -1;
+	pthread_mutex_lock(&ep->handlers_mutex);
 	
-	entry = malloc(sizeof(*entry));
-	if (!entry)
+	old = atomic_load_explicit(&ep->handlers, memory_order_relaxed);
+	count = old ? old->count : 0;
+	set = malloc(sizeof(*set) + (count + 1) * sizeof(set->entries[0]));
+	if (!set) {
+		pthread_mutex_unlock(&ep->handlers_mutex);
 		return -1;
-	
-	pthread_mutex_lock(&ep->handlers_mutex);
+	}
 	
 	id = ep->next_handler_id++;
-	entry->id = id;
-	entry->handler = handler;
-	entry->ctx = ctx;
-	entry->next = ep->handlers;
-	ep->handlers = entry;
+	set->count = count + 1;
+	set->entries[0].id = id;
+	set->entries[0].handler = handler;
+	set->entries[0].batch_handler = batch_handler;
+	set->entries[0].ctx = ctx;
+	if (count)
+		memcpy(&set->entries[1], old->entries, count * sizeof(set->entries[0]));
+	ep_replace_handlers(ep, set);
 	
 	pthread_mutex_unlock(&ep->handlers_mutex);
 	
 	return id;
 }
 
+int event_processor_register_handler(struct event_processor *ep,
+                                     event_handler_t handler, void *ctx)
+{
+	if (!ep || !handler)
+		return -1;
+	
+	return ep_add_handler(ep, handler, NULL, ctx);
+}
+
+int event_processor_register_batch_handler(struct event_processor *ep,
+                                           event_batch_handler_t handler, void *ctx)
+{
+	if (!ep || !handler)
+		return -1;
+	
+	return ep_add_handler(ep, NULL, handler, ctx);
+}
+
 void event_processor_unregister_handler(struct event_processor *ep, int handler_id)
 {
-	struct event_handler_entry *entry, *prev;
+	const struct ep_handler_set *old;
+	struct ep_handler_set *set = NULL;
+	size_t i, n = 0;
 	
 	if (!ep)
 		return;
 	
 	pthread_mutex_lock(&ep->handlers_mutex);
 	
-	prev = NULL;
-	for (entry = ep->handlers; entry; entry = entry->next) {
-		if (entry->id == handler_id) {
-			if (prev)
-				prev->next = entry->next;
-			else
-				ep->handlers = entry->next;
-			free(entry);
+	old = atomic_load_explicit(&ep->handlers, memory_order_relaxed);
+	for (i = 0; old && i < old->count && old->entries[i].id != handler_id; i++)
+		;
+	if (!old || i == old->count) {
+		pthread_mutex_unlock(&ep->handlers_mutex);
+		return;
+	}
+	
+	/* The last handler leaves no set; unregistering cannot fail, so wait out OOM */
+	while (old->count > 1 &&
+	       !(set = malloc(sizeof(*set) + (old->count - 1) * sizeof(set->entries[0]))))
+		sched_yield();
+	for (i = 0; set && i < old->count; i++) {
+		if (old->entries[i].id != handler_id)
+			set->entries[n++] = old->entries[i];
+	}
+	if (set)
+		set->count = n;
+	ep_replace_handlers(ep, set);
+	
+	pthread_mutex_unlock(&ep->handlers_mutex);
+}
+
+int event_processor_add_lane(struct event_processor *ep, size_t capacity)
+{
+	int lane;
+	
+	if (!ep)
+		return -1;
+	
+	if (capacity == 0)
+		capacity = ep->config.ring_buffer_size;
+	
+	pthread_mutex_lock(&ep->lanes_mutex);
+	
+	lane = atomic_load_explicit(&ep->lane_count, memory_order_relaxed);
+	if (lane >= EP_MAX_LANES ||
+	    ep_lane_init(ep, &ep->lanes[lane], capacity, false) < 0) {
+		pthread_mutex_unlock(&ep->lanes_mutex);
+		return -1;
+	}
+	
+	/* Publish the fully initialized lane to the dispatcher */
+	atomic_store_explicit(&ep->lane_count, lane + 1, memory_order_release);
+	
+	pthread_mutex_unlock(&ep->lanes_mutex);
+	
+	return lane;
+}
+
+/* Hash slot of an event type, fibonacci hashing */
+static size_t ep_type_slot(uint32_t event_type)
+{
+	return (uint32_t)(event_type * 2654435761u) >> 24;
+}
+
+/* Pick the priority class of an event */
+static size_t ep_classify(struct event_processor *ep, const struct nlmon_event *event)
+{
+	int priority = -1;
+	size_t slot, i;
+	
+	pthread_rwlock_rdlock(&ep->priority_lock);
+	
+	if (ep->classifier)
+		priority = ep->classifier(event, ep->classifier_ctx);
+	
+	if (priority < 0) {
+		slot = ep_type_slot(event->event_type);
+		for (i = 0; i < EP_PRIORITY_MAP_SIZE; i++) {
+			struct ep_priority_map_entry *entry =
+				&ep->priority_map[(slot + i) % EP_PRIORITY_MAP_SIZE];
+			
+			if (entry->priority < 0)
+				break;
+			if (entry->event_type == event->event_type) {
+				priority = entry->priority;
+				break;
+			}
+		}
+	}
+	
+	pthread_rwlock_unlock(&ep->priority_lock);
+	
+	if (priority < 0 || (size_t)priority >= ep->priority_count)
+		return ep->config.default_priority;
+	
+	return priority;
+}
+
+bool event_processor_set_type_priority(struct event_processor *ep,
+                                       uint32_t event_type,
+                                       unsigned int priority)
+{
+	size_t slot, i;
+	bool ok = false;
+	
+	if (!ep || priority >= ep->priority_count)
+		return false;
+	
+	pthread_rwlock_wrlock(&ep->priority_lock);
+	
+	/* Linear probing, entries are never removed only remapped */
+	slot = ep_type_slot(event_type);
+	for (i = 0; i < EP_PRIORITY_MAP_SIZE; i++) {
+		struct ep_priority_map_entry *entry =
+			&ep->priority_map[(slot + i) % EP_PRIORITY_MAP_SIZE];
+		
+		if (entry->priority < 0 || entry->event_type == event_type) {
+			entry->event_type = event_type;
+			entry->priority = priority;
+			ok = true;
 			break;
 		}
-		prev = entry;
 	}
 	
-	pthread_mutex_unlock(&ep->handlers_mutex);
+	pthread_rwlock_unlock(&ep->priority_lock);
+	
+	return ok;
 }
 
-bool event_processor_submit(struct event_processor *ep, struct nlmon_event *event)
+bool event_processor_set_classifier(struct event_processor *ep,
+                                    event_classifier_t classifier, void *ctx)
 {
-	struct nlmon_event *queued_event;
+	if (!ep || !ep->priority_count)
+		return false;
 	
-	if (!ep || !event)
+	pthread_rwlock_wrlock(&ep->priority_lock);
+	ep->classifier = classifier;
+	ep->classifier_ctx = ctx;
+	pthread_rwlock_unlock(&ep->priority_lock);
+	
+	return true;
+}
+
+/* Shedding entry of an event type, NULL once the table is full */
+static struct ep_shed_entry *ep_shed_entry(struct event_processor *ep, uint32_t event_type)
+{
+	unsigned long long key = (unsigned long long)event_type + 1;
+	unsigned long long cur;
+	size_t slot, i;
+	
+	slot = ep_type_slot(event_type);
+	for (i = 0; i < EP_SHED_TYPES; i++) {
+		struct ep_shed_entry *entry = &ep->shed[(slot + i) % EP_SHED_TYPES];
+		
+		cur = atomic_load_explicit(&entry->key, memory_order_acquire);
+		if (cur == 0 &&
+		    atomic_compare_exchange_strong_explicit(&entry->key, &cur, key,
+		                                            memory_order_acq_rel,
+		                                            memory_order_acquire))
+			return entry;
+		if (cur == key)
+			return entry;
+	}
+	
+	return NULL;
+}
+
+/* Account a shedding decision for an event type */
+static void ep_shed_count(struct event_processor *ep, uint32_t event_type,
+                          enum ep_shed_counter counter)
+{
+	struct ep_shed_entry *entry = ep_shed_entry(ep, event_type);
+	
+	if (entry)
+		atomic_fetch_add_explicit(&entry->counts[counter], 1, memory_order_relaxed);
+}
+
+/* Fill level of a ring in percent */
+static unsigned int ep_ring_fill(struct ring_buffer *rb)
+{
+	size_t capacity = ring_buffer_capacity(rb);
+	
+	return capacity ? (unsigned int)(ring_buffer_size(rb) * 100 / capacity) : 100;
+}
+
+/* True if drop-by-priority sheds an event of a class, urgent classes shed last */
+static bool ep_priority_shed(struct event_processor *ep, size_t priority)
+{
+	size_t queued = 0, capacity = 0, i;
+	unsigned int watermark = ep->config.overload_watermark;
+	unsigned int limit;
+	
+	/* The most urgent class is only ever refused by a full ring */
+	if (priority == 0)
 		return false;
 	
-	/* Check rate limit */
-	if (ep->rate_limiter) {
-		if (!rate_limiter_map_allow(ep->rate_limiter, event->event_type)) {
-			atomic_fetch_add_explicit(&ep->rate_limited_count, 1, memory_order_relaxed);
+	for (i = 0; i < ep->priority_count; i++) {
+		queued += ring_buffer_size(ep->priorities[i].ring_buffer);
+		capacity += ring_buffer_capacity(ep->priorities[i].ring_buffer);
+	}
+	
+	/* The least urgent class sheds at the watermark, the others in steps above it */
+	limit = watermark + (100 - watermark) * (ep->priority_count - 1 - priority) /
+	        (ep->priority_count - 1);
+	
+	return capacity && queued * 100 >= (size_t)limit * capacity;
+}
+
+/* Shed the oldest event of a full ring, false if its consumer cannot be shared */
+static bool ep_evict_oldest(struct event_processor *ep, struct ring_buffer *rb,
+                            pthread_mutex_t *consumer_mutex, struct ep_shard *shard)
+{
+	struct nlmon_event *oldest;
+	
+	/* Shard threads drain single-consumer rings without a lock */
+	if (!consumer_mutex && !rb->mpmc)
+		return false;
+	
+	if (consumer_mutex)
+		pthread_mutex_lock(consumer_mutex);
+	oldest = ring_buffer_dequeue(rb);
+	if (consumer_mutex)
+		pthread_mutex_unlock(consumer_mutex);
+	
+	/* Drained meanwhile, there is room now */
+	if (!oldest)
+		return true;
+	
+	ep_shed_count(ep, oldest->event_type, EP_SHED_EVICTED);
+	atomic_fetch_add_explicit(&ep->dropped_count, 1, memory_order_relaxed);
+	if (shard) {
+		atomic_fetch_add_explicit(&shard->dropped, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&shard->evicted, 1, memory_order_release);
+	}
+	ep_event_release(ep, oldest);
+	
+	return true;
+}
+
+/* Retry a full ring until the overload timeout expires */
+static bool ep_enqueue_wait(struct event_processor *ep, struct ring_buffer *rb,
+                            struct nlmon_event *event)
+{
+	struct timespec start, now;
+	long elapsed_ms;
+	
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	
+	do {
+		usleep(100);
+		if (ring_buffer_enqueue(rb, event))
+			return true;
+		
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed_ms = (now.tv_sec - start.tv_sec) * 1000 +
+		             (now.tv_nsec - start.tv_nsec) / 1000000;
+	} while (atomic_load_explicit(&ep->running, memory_order_acquire) &&
+	         elapsed_ms < (long)ep->config.overload_timeout_ms);
+	
+	return false;
+}
+
+/* Queue an event on its ring, applying the overload policy */
+static bool ep_enqueue(struct event_processor *ep, struct ring_buffer *rb,
+                       pthread_mutex_t *consumer_mutex, struct ep_shard *shard,
+                       struct nlmon_event *event, size_t priority)
+{
+	uint32_t event_type = event->event_type;
+	
+	/* Policies shedding before the ring is full */
+	switch (ep->config.overload_policy) {
+	case EVENT_OVERLOAD_SAMPLE:
+		if (ep_ring_fill(rb) >= ep->config.overload_watermark) {
+			struct ep_shed_entry *entry = ep_shed_entry(ep, event_type);
+			
+			/* Keep every Nth event of each type, so all types stay visible */
+			if (entry &&
+			    atomic_fetch_add_explicit(&entry->seen, 1, memory_order_relaxed) %
+			    ep->config.overload_sample_rate != 0) {
+				atomic_fetch_add_explicit(&entry->counts[EP_SHED_SAMPLED], 1,
+				                          memory_order_relaxed);
+				return false;
+			}
+		}
+		break;
+	case EVENT_OVERLOAD_DROP_PRIORITY:
+		if (ep->priority_count && ep_priority_shed(ep, priority)) {
+			ep_shed_count(ep, event_type, EP_SHED_DROPPED);
 			return false;
 		}
+		break;
+	default:
+		break;
 	}
 	
-	/* Allocate event from pool or copy */
-	queued_event = event_pool_alloc(ep->event_pool);
-	if (!queued_event) {
-		atomic_fetch_add_explicit(&ep->dropped_count, 1, memory_order_relaxed);
-		return false;
+	if (ring_buffer_enqueue(rb, event))
+		return true;
+	
+	/* Ring full */
+	switch (ep->config.overload_policy) {
+	case EVENT_OVERLOAD_DROP_OLDEST:
+		if (ep_evict_oldest(ep, rb, consumer_mutex, shard) && ring_buffer_enqueue(rb, event))
+			return true;
+		break;
+	case EVENT_OVERLOAD_BLOCK:
+		ep_shed_count(ep, event_type, EP_SHED_BLOCKED);
+		if (ep_enqueue_wait(ep, rb, event))
+			return true;
+		break;
+	default:
+		break;
 	}
 	
-	/* Copy event data */
-	memcpy(queued_event, event, sizeof(*queued_event));
+	ep_shed_count(ep, event_type, EP_SHED_DROPPED);
+	return false;
+}
+
+int nlmon_event_materialize(struct nlmon_event *event)
+{
+	struct nlmon_event_lazy *lazy;
 	
-	/* Copy event-specific data if present */
-	if (event->data && event->data_size > 0) {
-		queued_event->data = malloc(event->data_size);
-		if (queued_event->data) {
-			memcpy(queued_event->data, event->data, event->data_size);
-		} else {
+	if (!event || !event->netlink.lazy)
+		return 0;
+	
+	lazy = event->netlink.lazy;
+	return lazy->materialize(event);
+}
+
+bool event_processor_submit(struct event_processor *ep, struct nlmon_event *event)
+{
+	return event_processor_submit_lane(ep, 0, event);
+}
+
+/* Queue one event on a valid lane without waking the dispatcher */
+static bool ep_submit(struct event_processor *ep, int lane, struct nlmon_event *event)
+{
+	struct nlmon_event *queued_event;
+	
+	/* Check rate limit */
+	if (ep->rate_limiter) {
+		struct rate_limiter_key keys[2];
+		size_t key_count = 0;
+		
+		if (event->interface[0]) {
+			keys[key_count++] = (struct rate_limiter_key) {
+				.key_class = RATE_LIMITER_KEY_INTERFACE,
+				.name = event->interface,
+				.len = strnlen(event->interface, sizeof(event->interface)),
+			};
+		}
+		if (event->netlink.genl_family_name[0]) {
+			keys[key_count++] = (struct rate_limiter_key) {
+				.key_class = RATE_LIMITER_KEY_GENL_FAMILY,
+				.name = event->netlink.genl_family_name,
+				.len = strnlen(event->netlink.genl_family_name,
+				               sizeof(event->netlink.genl_family_name)),
+			};
+		}
+		
+		if (!rate_limiter_map_allow_keys(ep->rate_limiter, event->event_type,
+		                                 keys, key_count)) {
+			atomic_fetch_add_explicit(&ep->rate_limited_count, 1, memory_order_relaxed);
+			return false;
+		}
+	}
+	
+	if (nlmon_event_is_shared(event) &&
+	    atomic_load_explicit(&event->shared->refcount, memory_order_acquire) > 1) {
+		/* Other holders may read it or submit it too, queue a copy the
+		 * processor owns rather than stamp theirs */
+		queued_event = event_copy_shared(event);
+		if (!queued_event) {
+			ep_shed_count(ep, event->event_type, EP_SHED_DROPPED);
+			atomic_fetch_add_explicit(&ep->dropped_count, 1, memory_order_relaxed);
+			return false;
+		}
+	} else if (nlmon_event_is_shared(event)) {
+		/* The submitter holds the only reference, queue it by reference */
+		nlmon_event_materialize(event);
+		queued_event = nlmon_event_share(event);
+	} else {
+		/* A pending decode does not outlive the producer's callback */
+		nlmon_event_materialize(event);
+		
+		/* Allocate event from pool or copy */
+		queued_event = event_pool_alloc(ep->event_pool);
+		if (!queued_event) {
+			ep_shed_count(ep, event->event_type, EP_SHED_DROPPED);
+			atomic_fetch_add_explicit(&ep->dropped_count, 1, memory_order_relaxed);
+			return false;
+		}
+		
+		/* Copy event data */
+		memcpy(queued_event, event, sizeof(*queued_event));
+		queued_event->shared = NULL;
+		
+		/* The copy carries the trace on */
+		event->trace.recv_ns = 0;
+		
+		/* Copy event-specific data if present, inline when small */
+		if (nlmon_event_copy_data(queued_event, event->data, event->data_size) < 0) {
+			queued_event->data = NULL;
 			event_pool_free(ep->event_pool, queued_event);
 			atomic_fetch_add_explicit(&ep->dropped_count, 1, memory_order_relaxed);
 			return false;
 		}
 	}
 	
-	/* Assign sequence number */
+	/* Only the queued event is stamped, it belongs to the processor */
+	nlmon_trace_stamp(&queued_event->trace, NLMON_TRACE_SUBMIT);
 	queued_event->sequence = atomic_fetch_add_explicit(&ep->sequence_counter, 1,
 	                                                   memory_order_relaxed);
-	
-	/* Enqueue to ring buffer */
-	if (!ring_buffer_enqueue(ep->ring_buffer, queued_event)) {
-		event_pool_free(ep->event_pool, queued_event);
+	NLMON_PROBE3(event_submit, queued_event->event_type, queued_event->sequence, lane);
+	
+	/* Enqueue to the producer's lane, its ring of the event's shard or the event's class */
+	if (ep->shard_count) {
+		struct ep_shard *shard = &ep->shards[ep_shard_route(ep, queued_event)];
+		
+		if (!ep_enqueue(ep, ep->lanes[lane].shard_rings[shard->index], NULL, shard,
+		                queued_event, 0)) {
+			ep_event_release(ep, queued_event);
+			atomic_fetch_add_explicit(&shard->dropped, 1, memory_order_relaxed);
+			atomic_fetch_add_explicit(&ep->dropped_count, 1, memory_order_relaxed);
+			return false;
+		}
+		
+		atomic_fetch_add_explicit(&shard->submitted, 1, memory_order_relaxed);
+	} else if (ep->priority_count) {
+		size_t priority = ep_classify(ep, queued_event);
+		struct ep_priority *prio = &ep->priorities[priority];
+		
+		if (!ep_enqueue(ep, prio->ring_buffer, NULL, NULL, queued_event, priority)) {
+			ep_event_release(ep, queued_event);
+			atomic_fetch_add_explicit(&prio->dropped, 1, memory_order_relaxed);
+			atomic_fetch_add_explicit(&ep->dropped_count, 1, memory_order_relaxed);
+			return false;
+		}
+		
+		atomic_fetch_add_explicit(&prio->submitted, 1, memory_order_relaxed);
+	} else if (!ep_enqueue(ep, ep->lanes[lane].ring_buffer,
+	                       &ep->lanes[lane].consumer_mutex, NULL, queued_event, 0)) {
+		ep_event_release(ep, queued_event);
 		atomic_fetch_add_explicit(&ep->dropped_count, 1, memory_order_relaxed);
 		return false;
 	}
@@ -487,6 +1836,44 @@ bool event_processor_submit(struct event_processor *ep, struct nlmon_event *even
 	return true;
 }
 
+bool event_processor_submit_lane(struct event_processor *ep, int lane,
+                                 struct nlmon_event *event)
+{
+	if (!ep || !event)
+		return false;
+	
+	if (lane < 0 || lane >= atomic_load_explicit(&ep->lane_count, memory_order_acquire))
+		return false;
+	
+	if (!ep_submit(ep, lane, event))
+		return false;
+	
+	ep_wake(ep);
+	return true;
+}
+
+size_t event_processor_submit_batch(struct event_processor *ep, int lane,
+                                    struct nlmon_event *events, size_t count)
+{
+	size_t submitted = 0;
+	
+	if (!ep || !events)
+		return 0;
+	
+	if (lane < 0 || lane >= atomic_load_explicit(&ep->lane_count, memory_order_acquire))
+		return 0;
+	
+	for (size_t i = 0; i < count; i++) {
+		if (ep_submit(ep, lane, &events[i]))
+			submitted++;
+	}
+	
+	/* One wakeup for the whole batch */
+	if (submitted)
+		ep_wake(ep);
+	return submitted;
+}
+
 bool event_processor_set_rate_limit(struct event_processor *ep,
                                     uint32_t event_type,
                                     double rate, size_t burst)
@@ -497,13 +1884,85 @@ bool event_processor_set_rate_limit(struct event_processor *ep,
 	return rate_limiter_map_set(ep->rate_limiter, event_type, rate, burst);
 }
 
+bool event_processor_set_key_rate_limit(struct event_processor *ep,
+                                        enum rate_limiter_key_class key_class,
+                                        double rate, size_t burst)
+{
+	if (!ep || !ep->rate_limiter)
+		return false;
+	
+	return rate_limiter_map_set_key_limit(ep->rate_limiter, key_class, rate, burst);
+}
+
+size_t event_processor_rate_limited_keys(struct event_processor *ep,
+                                         struct rate_limiter_key_stats *stats,
+                                         size_t max)
+{
+	if (!ep || !ep->rate_limiter)
+		return 0;
+	
+	return rate_limiter_map_top_keys(ep->rate_limiter, stats, max);
+}
+
+/* Number of events queued for one shard across all lanes */
+static size_t ep_shard_queued(struct event_processor *ep, size_t shard)
+{
+	size_t total = 0;
+	int i, count;
+	
+	count = atomic_load_explicit(&ep->lane_count, memory_order_acquire);
+	for (i = 0; i < count; i++)
+		total += ring_buffer_size(ep->lanes[i].shard_rings[shard]);
+	
+	return total;
+}
+
+/* Total number of events queued across all lanes */
+static size_t ep_queued_events(struct event_processor *ep)
+{
+	size_t total = 0;
+	size_t s;
+	int i, count;
+	
+	if (ep->shard_count) {
+		for (s = 0; s < ep->shard_count; s++)
+			total += ep_shard_queued(ep, s);
+		return total;
+	}
+	
+	count = atomic_load_explicit(&ep->lane_count, memory_order_acquire);
+	for (i = 0; i < count; i++)
+		total += ring_buffer_size(ep->lanes[i].ring_buffer);
+	for (s = 0; s < ep->priority_count; s++)
+		total += ring_buffer_size(ep->priorities[s].ring_buffer);
+	
+	return total;
+}
+
+/* True while a shard thread may still be running a handler */
+static bool ep_shards_busy(struct event_processor *ep)
+{
+	size_t i;
+	
+	for (i = 0; i < ep->shard_count; i++) {
+		struct ep_shard *shard = &ep->shards[i];
+		
+		if (atomic_load_explicit(&shard->processed, memory_order_acquire) +
+		    atomic_load_explicit(&shard->evicted, memory_order_acquire) <
+		    atomic_load_explicit(&shard->submitted, memory_order_acquire))
+			return true;
+	}
+	
+	return false;
+}
+
 void event_processor_wait(struct event_processor *ep)
 {
 	if (!ep)
 		return;
 	
-	/* Wait for ring buffer to drain */
-	while (!ring_buffer_is_empty(ep->ring_buffer))
+	/* Wait for all lanes to drain */
+	while (ep_queued_events(ep) > 0 || ep_shards_busy(ep))
 		usleep(1000);
 	
 	/* Wait for thread pool */
@@ -530,7 +1989,142 @@ void event_processor_stats(struct event_processor *ep,
 	if (rate_limited)
 		*rate_limited = atomic_load_explicit(&ep->rate_limited_count, memory_order_relaxed);
 	if (queue_size)
-		*queue_size = ring_buffer_size(ep->ring_buffer);
+		*queue_size = ep_queued_events(ep);
 	if (pool_usage)
-		*pool_usage = event_pool_usage(ep->event_pool);
+		*pool_usage = object_pool_get_usage(ep->event_pool);
+}
+
+void event_processor_collect_stats(struct nlmon_stats_snapshot *snapshot, void *ctx)
+{
+	struct event_processor *ep = ctx;
+	unsigned long submitted = 0, processed = 0, dropped = 0, rate_limited = 0;
+	unsigned long completed = 0, rejected = 0;
+	
+	if (!ep)
+		return;
+	
+	event_processor_stats(ep, &submitted, &processed, &dropped, &rate_limited,
+	                      &snapshot->events.queue_size, &snapshot->events.pool_usage);
+	snapshot->events.submitted = submitted;
+	snapshot->events.processed = processed;
+	snapshot->events.dropped = dropped;
+	snapshot->events.rate_limited = rate_limited;
+	snapshot->have |= STATS_HAVE_EVENTS;
+	
+	/* Sharded processors dispatch on shard threads, without a pool */
+	if (!ep->thread_pool)
+		return;
+	
+	submitted = 0;
+	thread_pool_stats(ep->thread_pool, &submitted, &completed, &rejected);
+	snapshot->thread_pool.submitted = submitted;
+	snapshot->thread_pool.completed = completed;
+	snapshot->thread_pool.rejected = rejected;
+	snapshot->thread_pool.threads = thread_pool_get_thread_count(ep->thread_pool);
+	snapshot->thread_pool.pending = thread_pool_get_pending_count(ep->thread_pool);
+	snapshot->have |= STATS_HAVE_THREAD_POOL;
+}
+
+void event_processor_wakeup_stats(struct event_processor *ep,
+                                  struct event_processor_wakeup_stats *stats)
+{
+	unsigned long woken;
+	
+	if (!ep || !stats)
+		return;
+	
+	memset(stats, 0, sizeof(*stats));
+	if (ep->shard_count)
+		return;
+	
+	stats->idle_spins = atomic_load_explicit(&ep->idle_spins, memory_order_relaxed);
+	stats->parks = atomic_load_explicit(&ep->parks, memory_order_relaxed);
+	stats->wakeups = atomic_load_explicit(&ep->wakeups, memory_order_relaxed);
+	stats->parked_ns = atomic_load_explicit(&ep->parked_ns, memory_order_relaxed);
+	stats->wakeup_latency_max_ns = atomic_load_explicit(&ep->wake_latency_max_ns,
+	                                                    memory_order_relaxed);
+	woken = atomic_load_explicit(&ep->woken, memory_order_relaxed);
+	if (woken)
+		stats->wakeup_latency_avg_ns = atomic_load_explicit(&ep->wake_latency_ns,
+		                                                    memory_order_relaxed) / woken;
+	stats->spin_limit = atomic_load_explicit(&ep->spin_limit, memory_order_relaxed);
+}
+
+size_t event_processor_shard_stats(struct event_processor *ep,
+                                   struct event_processor_shard_stats *stats,
+                                   size_t max)
+{
+	size_t i;
+	
+	if (!ep)
+		return 0;
+	
+	for (i = 0; i < ep->shard_count && i < max && stats; i++) {
+		struct ep_shard *shard = &ep->shards[i];
+		
+		stats[i].cpu = shard->cpu;
+		stats[i].submitted = atomic_load_explicit(&shard->submitted, memory_order_relaxed);
+		stats[i].processed = atomic_load_explicit(&shard->processed, memory_order_relaxed);
+		stats[i].dropped = atomic_load_explicit(&shard->dropped, memory_order_relaxed);
+		stats[i].queue_size = ep_shard_queued(ep, i);
+	}
+	
+	return ep->shard_count;
+}
+
+size_t event_processor_priority_stats(struct event_processor *ep,
+                                      struct event_processor_priority_stats *stats,
+                                      size_t max)
+{
+	size_t i;
+	
+	if (!ep)
+		return 0;
+	
+	for (i = 0; i < ep->priority_count && i < max && stats; i++) {
+		struct ep_priority *prio = &ep->priorities[i];
+		
+		stats[i].submitted = atomic_load_explicit(&prio->submitted, memory_order_relaxed);
+		stats[i].dispatched = atomic_load_explicit(&prio->dispatched, memory_order_relaxed);
+		stats[i].dropped = atomic_load_explicit(&prio->dropped, memory_order_relaxed);
+		stats[i].queue_size = ring_buffer_size(prio->ring_buffer);
+	}
+	
+	return ep->priority_count;
+}
+
+size_t event_processor_shed_stats(struct event_processor *ep,
+                                  struct event_processor_shed_stats *stats,
+                                  size_t max)
+{
+	size_t i, count = 0;
+	
+	if (!ep)
+		return 0;
+	
+	for (i = 0; i < EP_SHED_TYPES; i++) {
+		struct ep_shed_entry *entry = &ep->shed[i];
+		struct event_processor_shed_stats st;
+		unsigned long long key;
+		
+		key = atomic_load_explicit(&entry->key, memory_order_acquire);
+		if (!key)
+			continue;
+		
+		st.event_type = (uint32_t)(key - 1);
+		st.dropped = atomic_load_explicit(&entry->counts[EP_SHED_DROPPED], memory_order_relaxed);
+		st.evicted = atomic_load_explicit(&entry->counts[EP_SHED_EVICTED], memory_order_relaxed);
+		st.sampled = atomic_load_explicit(&entry->counts[EP_SHED_SAMPLED], memory_order_relaxed);
+		st.blocked = atomic_load_explicit(&entry->counts[EP_SHED_BLOCKED], memory_order_relaxed);
+		
+		/* Types only seen while sampling were never shed */
+		if (!st.dropped && !st.evicted && !st.sampled && !st.blocked)
+			continue;
+		
+		if (stats && count < max)
+			stats[count] = st;
+		count++;
+	}
+	
+	return count;
 }
@@ -0,0 +1,484 @@
+/* event_sampler.c - Per event type sampling of an event stream
+ *
+ * Event types are found through a small open addressed table over a
+ * fixed array of states. All types share the sampler's interval; when it
+ * ends the reservoirs are emptied, merged by timestamp, and the rate
+ * estimates of adaptive types are updated.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <linux/netlink.h>
+#include "event_sampler.h"
+#include "event_processor.h"
+
+#define TYPE_SLOTS (EVENT_SAMPLER_MAX_TYPES * 2)
+
+/* Sampling state of one event type */
+struct sample_type {
+	uint64_t key;
+	struct event_sampler_rule rule;
+	uint64_t count;                 /* Events this interval */
+	
+	/* FIXED */
+	uint32_t phase;
+	
+	/* RESERVOIR, slots allocated on first use */
+	struct nlmon_event **slots;
+	uint32_t filled;
+	
+	/* ADAPTIVE */
+	uint32_t k;                     /* Keep 1 in k */
+	uint64_t kept;                  /* Kept this interval at the current k */
+	double rate;                    /* Events per second, negative before the first interval */
+};
+
+/* Reservoir event waiting to be handed on */
+struct held_event {
+	struct nlmon_event *event;
+	uint32_t weight;
+};
+
+struct event_sampler {
+	struct event_sampler_rule *rules;
+	size_t num_rules;
+	struct event_sampler_rule fallback;
+	uint64_t interval_ns;
+	uint64_t interval_start;        /* 0 before the first event */
+	bool holds;
+	uint64_t rng;
+	
+	struct sample_type types[EVENT_SAMPLER_MAX_TYPES];
+	uint32_t num_types;
+	uint16_t slots[TYPE_SLOTS];     /* Index + 1 into types, 0 for free */
+	struct sample_type overflow_type;
+	
+	struct held_event *held;        /* Scratch for closing the reservoirs */
+	size_t held_size;
+	
+	/* Statistics */
+	uint64_t seen;
+	uint64_t kept;
+	uint64_t weight;
+	uint64_t held_count;
+	uint64_t overflow;
+};
+
+static uint64_t next_random(struct event_sampler *sampler)
+{
+	/* xorshift64 */
+	uint64_t x = sampler->rng;
+	
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	sampler->rng = x;
+	return x;
+}
+
+/* Uniform in [0, 1) */
+static double next_unit(struct event_sampler *sampler)
+{
+	return (next_random(sampler) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Integer weight whose expectation is w */
+static uint32_t round_weight(struct event_sampler *sampler, double w)
+{
+	double whole = floor(w);
+	
+	if (whole >= UINT32_MAX)
+		return UINT32_MAX;
+	if (next_unit(sampler) < w - whole)
+		whole += 1;
+	return whole < 1 ? 1 : (uint32_t)whole;
+}
+
+static uint64_t type_key(const struct nlmon_event *event)
+{
+	uint64_t key = (uint64_t)event->event_type << 16;
+	
+	if (event->netlink.protocol == NETLINK_GENERIC)
+		key |= 0x100 | event->netlink.genl_cmd;
+	return key;
+}
+
+static uint64_t hash_key(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	return x;
+}
+
+/* Rule of an event, a rule for its command before one for any command */
+static const struct event_sampler_rule *find_rule(struct event_sampler *sampler,
+                                                  const struct nlmon_event *event)
+{
+	const struct event_sampler_rule *any = NULL;
+	
+	for (size_t i = 0; i < sampler->num_rules; i++) {
+		const struct event_sampler_rule *rule = &sampler->rules[i];
+	
+		if (rule->event_type != event->event_type)
+			continue;
+		if (!rule->by_cmd) {
+			if (!any)
+				any = rule;
+		} else if (event->netlink.protocol == NETLINK_GENERIC &&
+		           event->netlink.genl_cmd == rule->genl_cmd) {
+			return rule;
+		}
+	}
+	return any ? any : &sampler->fallback;
+}
+
+static void type_init(struct event_sampler *sampler, struct sample_type *type, uint64_t key,
+                      const struct event_sampler_rule *rule)
+{
+	memset(type, 0, sizeof(*type));
+	type->key = key;
+	type->rule = *rule;
+	type->k = 1;
+	type->rate = -1;
+	
+	/* A random start keeps 1:N unbiased over short runs */
+	if (rule->mode == EVENT_SAMPLER_FIXED)
+		type->phase = (uint32_t)(next_random(sampler) % rule->rate);
+}
+
+static struct sample_type *find_type(struct event_sampler *sampler,
+                                     const struct nlmon_event *event)
+{
+	uint64_t key = type_key(event);
+	size_t slot = hash_key(key) & (TYPE_SLOTS - 1);
+	struct sample_type *type;
+	
+	for (;;) {
+		uint16_t index = sampler->slots[slot];
+	
+		if (index == 0)
+			break;
+		if (sampler->types[index - 1].key == key)
+			return &sampler->types[index - 1];
+		slot = (slot + 1) & (TYPE_SLOTS - 1);
+	}
+	
+	if (sampler->num_types == EVENT_SAMPLER_MAX_TYPES) {
+		sampler->overflow++;
+		return &sampler->overflow_type;
+	}
+	
+	type = &sampler->types[sampler->num_types++];
+	type_init(sampler, type, key, find_rule(sampler, event));
+	sampler->slots[slot] = (uint16_t)sampler->num_types;
+	return type;
+}
+
+static int held_compare(const void *a, const void *b)
+{
+	const struct nlmon_event *x = ((const struct held_event *)a)->event;
+	const struct nlmon_event *y = ((const struct held_event *)b)->event;
+	
+	if (x->timestamp != y->timestamp)
+		return x->timestamp < y->timestamp ? -1 : 1;
+	if (x->sequence != y->sequence)
+		return x->sequence < y->sequence ? -1 : 1;
+	return 0;
+}
+
+/* Move the events of the reservoirs to the scratch array with their weights */
+static size_t reservoirs_take(struct event_sampler *sampler)
+{
+	size_t n = 0;
+	
+	if (sampler->held_count > sampler->held_size) {
+		struct held_event *held = realloc(sampler->held,
+		                                  sampler->held_count * sizeof(*held));
+	
+		/* Without room the reservoirs go on filling */
+		if (!held)
+			return 0;
+		sampler->held = held;
+		sampler->held_size = sampler->held_count;
+	}
+	
+	for (uint32_t i = 0; i <= sampler->num_types; i++) {
+		struct sample_type *type = i < sampler->num_types ? &sampler->types[i] :
+		                           &sampler->overflow_type;
+		double w;
+	
+		if (type->rule.mode != EVENT_SAMPLER_RESERVOIR)
+			continue;
+	
+		w = type->filled ? (double)type->count / type->filled : 1;
+		for (uint32_t j = 0; j < type->filled; j++) {
+			sampler->held[n].event = type->slots[j];
+			sampler->held[n].weight = round_weight(sampler, w);
+			type->slots[j] = NULL;
+			n++;
+		}
+		type->filled = 0;
+		type->count = 0;
+	}
+	return n;
+}
+
+/* Hand the events taken from the reservoirs on in timestamp order */
+static size_t reservoirs_close(struct event_sampler *sampler, event_sampler_fn fn, void *ctx)
+{
+	size_t n = reservoirs_take(sampler);
+	
+	qsort(sampler->held, n, sizeof(*sampler->held), held_compare);
+	for (size_t i = 0; i < n; i++) {
+		if (fn)
+			fn(sampler->held[i].event, sampler->held[i].weight, ctx);
+		sampler->kept++;
+		sampler->weight += sampler->held[i].weight;
+		nlmon_event_put(sampler->held[i].event);
+	}
+	sampler->held_count -= n;
+	return n;
+}
+
+/* Follow the event rates of adaptive types over an interval of elapsed_ns */
+static void rates_update(struct event_sampler *sampler, uint64_t elapsed_ns)
+{
+	double seconds = elapsed_ns / 1e9;
+	
+	for (uint32_t i = 0; i <= sampler->num_types; i++) {
+		struct sample_type *type = i < sampler->num_types ? &sampler->types[i] :
+		                           &sampler->overflow_type;
+		double rate, k;
+	
+		if (type->rule.mode == EVENT_SAMPLER_ADAPTIVE) {
+			rate = type->count / seconds;
+			type->rate = type->rate < 0 ? rate : (type->rate + rate) / 2;
+			k = ceil(type->rate / type->rule.rate);
+			type->k = k < 1 ? 1 : k > UINT32_MAX ? UINT32_MAX : (uint32_t)k;
+			type->kept = 0;
+		}
+		type->count = 0;
+	}
+}
+
+/* Keep an event in a reservoir, uniformly among the events of its interval */
+static void reservoir_offer(struct event_sampler *sampler, struct sample_type *type,
+                            struct nlmon_event *event)
+{
+	uint32_t cap = type->rule.rate;
+	uint64_t pick;
+	
+	if (!type->slots) {
+		type->slots = calloc(cap, sizeof(*type->slots));
+		if (!type->slots)
+			return;
+	}
+	
+	if (type->filled < cap) {
+		pick = type->filled;
+	} else {
+		pick = next_random(sampler) % type->count;
+		if (pick >= cap)
+			return;
+	}
+	
+	event = nlmon_event_share(event);
+	if (!event)
+		return;
+	
+	if (pick < type->filled) {
+		nlmon_event_put(type->slots[pick]);
+	} else {
+		type->filled++;
+		sampler->held_count++;
+	}
+	type->slots[pick] = event;
+}
+
+/* Keep 1 in k, k doubling when a burst overruns the interval's budget */
+static uint32_t adaptive_offer(struct event_sampler *sampler, struct sample_type *type)
+{
+	uint64_t budget = (uint64_t)type->rule.rate * sampler->interval_ns / 1000000000ULL;
+	uint32_t weight = type->k;
+	
+	if (type->k > 1 && next_random(sampler) % type->k != 0)
+		return 0;
+	
+	if (++type->kept >= 2 * (budget ? budget : 1) && type->k <= UINT32_MAX / 2) {
+		type->k *= 2;
+		type->kept = 0;
+	}
+	return weight;
+}
+
+bool event_sampler_config_active(const struct event_sampler_config *config)
+{
+	if (!config)
+		return false;
+	if (config->fallback.mode != EVENT_SAMPLER_ALL)
+		return true;
+	for (size_t i = 0; i < config->num_rules; i++) {
+		if (config->rules[i].mode != EVENT_SAMPLER_ALL)
+			return true;
+	}
+	return false;
+}
+
+struct event_sampler *event_sampler_create(const struct event_sampler_config *config)
+{
+	struct event_sampler *sampler;
+	struct timespec ts;
+	
+	if (!config || (config->num_rules > 0 && !config->rules))
+		return NULL;
+	if (config->fallback.mode != EVENT_SAMPLER_ALL && config->fallback.rate == 0)
+		return NULL;
+	for (size_t i = 0; i < config->num_rules; i++) {
+		if (config->rules[i].mode != EVENT_SAMPLER_ALL && config->rules[i].rate == 0)
+			return NULL;
+	}
+	
+	sampler = calloc(1, sizeof(*sampler));
+	if (!sampler)
+		return NULL;
+	
+	if (config->num_rules > 0) {
+		sampler->rules = calloc(config->num_rules, sizeof(*sampler->rules));
+		if (!sampler->rules) {
+			free(sampler);
+			return NULL;
+		}
+		memcpy(sampler->rules, config->rules, config->num_rules * sizeof(*sampler->rules));
+		sampler->num_rules = config->num_rules;
+	}
+	sampler->fallback = config->fallback;
+	sampler->interval_ns = (uint64_t)(config->interval_ms ? config->interval_ms :
+	                                  EVENT_SAMPLER_INTERVAL_MS) * 1000000ULL;
+	
+	sampler->holds = sampler->fallback.mode == EVENT_SAMPLER_RESERVOIR;
+	for (size_t i = 0; i < sampler->num_rules; i++) {
+		if (sampler->rules[i].mode == EVENT_SAMPLER_RESERVOIR)
+			sampler->holds = true;
+	}
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	sampler->rng = ((uint64_t)ts.tv_nsec << 20) ^ (uintptr_t)sampler ^ 0x9e3779b97f4a7c15ULL;
+	if (sampler->rng == 0)
+		sampler->rng = 1;
+	
+	type_init(sampler, &sampler->overflow_type, 0, &sampler->fallback);
+	
+	return sampler;
+}
+
+void event_sampler_destroy(struct event_sampler *sampler)
+{
+	if (!sampler)
+		return;
+	
+	for (uint32_t i = 0; i <= sampler->num_types; i++) {
+		struct sample_type *type = i < sampler->num_types ? &sampler->types[i] :
+		                           &sampler->overflow_type;
+	
+		for (uint32_t j = 0; j < type->filled; j++)
+			nlmon_event_put(type->slots[j]);
+		free(type->slots);
+	}
+	free(sampler->held);
+	free(sampler->rules);
+	free(sampler);
+}
+
+uint32_t event_sampler_offer(struct event_sampler *sampler, struct nlmon_event *event,
+                             uint64_t now_ns, event_sampler_fn fn, void *ctx)
+{
+	struct sample_type *type;
+	uint32_t weight = 0;
+	
+	if (!sampler || !event)
+		return 0;
+	
+	if (sampler->interval_start == 0)
+		sampler->interval_start = now_ns ? now_ns : 1;
+	else
+		event_sampler_tick(sampler, now_ns, fn, ctx);
+	
+	sampler->seen++;
+	type = find_type(sampler, event);
+	type->count++;
+	
+	switch (type->rule.mode) {
+	case EVENT_SAMPLER_FIXED:
+		if (type->phase == 0)
+			weight = type->rule.rate;
+		type->phase = type->phase ? type->phase - 1 : type->rule.rate - 1;
+		break;
+	case EVENT_SAMPLER_RESERVOIR:
+		reservoir_offer(sampler, type, event);
+		break;
+	case EVENT_SAMPLER_ADAPTIVE:
+		weight = adaptive_offer(sampler, type);
+		break;
+	default:
+		weight = 1;
+		break;
+	}
+	
+	if (weight) {
+		sampler->kept++;
+		sampler->weight += weight;
+	}
+	return weight;
+}
+
+size_t event_sampler_tick(struct event_sampler *sampler, uint64_t now_ns,
+                          event_sampler_fn fn, void *ctx)
+{
+	uint64_t elapsed;
+	size_t n;
+	
+	if (!sampler || sampler->interval_start == 0 || now_ns < sampler->interval_start)
+		return 0;
+	
+	elapsed = now_ns - sampler->interval_start;
+	if (elapsed < sampler->interval_ns)
+		return 0;
+	
+	/* Intervals that passed without events count as one */
+	sampler->interval_start = now_ns - elapsed % sampler->interval_ns;
+	n = reservoirs_close(sampler, fn, ctx);
+	rates_update(sampler, elapsed);
+	return n;
+}
+
+size_t event_sampler_drain(struct event_sampler *sampler, event_sampler_fn fn, void *ctx)
+{
+	/* Rates are left to the end of the interval */
+	return sampler ? reservoirs_close(sampler, fn, ctx) : 0;
+}
+
+bool event_sampler_holds(const struct event_sampler *sampler)
+{
+	return sampler && sampler->holds;
+}
+
+void event_sampler_get_stats(const struct event_sampler *sampler,
+                             struct event_sampler_stats *stats)
+{
+	if (!stats)
+		return;
+	
+	memset(stats, 0, sizeof(*stats));
+	if (!sampler)
+		return;
+	
+	stats->seen = sampler->seen;
+	stats->kept = sampler->kept;
+	stats->weight = sampler->weight;
+	stats->held = sampler->held_count;
+	stats->overflow = sampler->overflow;
+	stats->types = sampler->num_types;
+}
@@ -0,0 +1,101 @@
+/* event_trace.c - Per-event latency tracing through the pipeline */
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include "event_trace.h"
+
+/* Installed sink, read by every stage that finishes a trace */
+struct trace_sink {
+	nlmon_trace_sink_fn fn;
+	void *ctx;
+	unsigned int sample_rate;
+};
+
+/* Two slots so that replacing the sink never changes the one in use */
+static struct trace_sink sinks[2];
+static _Atomic(struct trace_sink *) current_sink;
+static _Atomic uint32_t next_id;
+
+void nlmon_trace_set_sink(nlmon_trace_sink_fn fn, void *ctx, unsigned int sample_rate)
+{
+	struct trace_sink *sink;
+	
+	if (!fn) {
+		atomic_store_explicit(&current_sink, NULL, memory_order_release);
+		return;
+	}
+	
+	sink = atomic_load_explicit(&current_sink, memory_order_relaxed) == &sinks[0] ?
+	       &sinks[1] : &sinks[0];
+	sink->fn = fn;
+	sink->ctx = ctx;
+	sink->sample_rate = sample_rate;
+	atomic_store_explicit(&current_sink, sink, memory_order_release);
+}
+
+bool nlmon_trace_enabled(void)
+{
+	return atomic_load_explicit(&current_sink, memory_order_relaxed) != NULL;
+}
+
+void nlmon_trace_begin(struct nlmon_event_trace *trace, uint64_t recv_ns)
+{
+	struct trace_sink *sink = atomic_load_explicit(&current_sink, memory_order_acquire);
+	
+	trace->recv_ns = 0;
+	if (!sink)
+		return;
+	
+	for (int i = 0; i < NLMON_TRACE_STAGES; i++)
+		trace->offset_ns[i] = 0;
+	trace->id = atomic_fetch_add_explicit(&next_id, 1, memory_order_relaxed);
+	trace->flags = 0;
+	if (sink->sample_rate && trace->id % sink->sample_rate == 0)
+		trace->flags |= NLMON_TRACE_SAMPLED;
+	
+	trace->recv_ns = recv_ns ? recv_ns : nlmon_trace_now();
+	trace->offset_ns[NLMON_TRACE_RECV] = 1;
+}
+
+static void trace_deliver(struct nlmon_event_trace *trace, enum nlmon_trace_stage stage)
+{
+	struct trace_sink *sink = atomic_load_explicit(&current_sink, memory_order_acquire);
+	
+	if (sink)
+		sink->fn(trace, stage, sink->ctx);
+}
+
+void nlmon_trace_finish(struct nlmon_event_trace *trace, enum nlmon_trace_stage stage)
+{
+	if (!trace->recv_ns)
+		return;
+	
+	nlmon_trace_stamp(trace, stage);
+	trace_deliver(trace, NLMON_TRACE_STAGES);
+	trace->recv_ns = 0;
+}
+
+void nlmon_trace_report(struct nlmon_event_trace *trace, enum nlmon_trace_stage stage)
+{
+	if (!trace->recv_ns)
+		return;
+	
+	nlmon_trace_stamp(trace, stage);
+	trace_deliver(trace, stage);
+}
+
+const char *nlmon_trace_stage_name(enum nlmon_trace_stage stage)
+{
+	static const char *const names[NLMON_TRACE_STAGES] = {
+		[NLMON_TRACE_RECV] = "recv",
+		[NLMON_TRACE_PARSE] = "parse",
+		[NLMON_TRACE_SUBMIT] = "submit",
+		[NLMON_TRACE_DISPATCH] = "dispatch",
+		[NLMON_TRACE_FILTER] = "filter",
+		[NLMON_TRACE_HANDLER] = "handler",
+		[NLMON_TRACE_STORAGE] = "storage",
+		[NLMON_TRACE_EXPORT] = "export",
+	};
+	
+	return (unsigned int)stage < NLMON_TRACE_STAGES ? names[stage] : "unknown";
+}
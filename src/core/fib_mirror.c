@@ -0,0 +1,770 @@
+/* fib_mirror.c - Path-compressed tries of the kernel routing tables
+ *
+ * Each node holds a prefix and two children, the child taken at the first
+ * bit past the prefix. Prefixes only appear where a route is or where two
+ * subtrees part, chains of single-child nodes are never built, so a trie
+ * of n routes has fewer than 2n nodes and no path is longer than the
+ * address. Nodes without routes are removed as soon as they stop parting
+ * subtrees.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "fib_mirror.h"
+#include "nlmon_nl_route.h"
+
+/* Index 0 is never handed out and stands for no node or route */
+#define FIB_NONE 0
+
+/* Longest prefix, IPv6 */
+#define FIB_MAX_BITS 128
+
+/* First allocation of the node and route arrays, in items */
+#define FIB_MIN_CAPACITY 64
+
+/* Trie node */
+struct fib_node {
+	uint8_t key[16];                 /* Prefix, bits past plen are zero */
+	uint8_t plen;                    /* Prefix length */
+	uint32_t child[2];               /* Subtrees by the bit past the prefix */
+	uint32_t route;                  /* Routes of the prefix, by priority and TOS */
+};
+
+/* Route of a prefix */
+struct fib_route {
+	uint8_t gateway[16];
+	bool has_gateway;
+	uint8_t tos;
+	uint8_t protocol;
+	uint8_t scope;
+	uint8_t type;
+	uint32_t oif;
+	uint32_t priority;
+	uint32_t next;                   /* Next route of the prefix */
+	time_t since;
+};
+
+/* Trie of one table and family */
+struct fib_trie {
+	unsigned int table;
+	int family;
+	uint32_t root;
+	struct fib_trie *next;
+};
+
+/* Items of one size addressed by index, freed ones are linked through
+ * their first four bytes */
+struct fib_array {
+	char *items;
+	size_t item_size;
+	uint32_t count;                  /* Items ever handed out, with index 0 */
+	uint32_t capacity;
+	uint32_t free;                   /* First free item */
+	size_t used;                     /* Items in use */
+};
+
+struct fib_mirror {
+	pthread_rwlock_t lock;
+	struct fib_trie *tries;
+	struct fib_array nodes;
+	struct fib_array routes;
+	size_t max_routes;
+};
+
+#define NODE(fib, i) ((struct fib_node *)array_at(&(fib)->nodes, (i)))
+#define ROUTE(fib, i) ((struct fib_route *)array_at(&(fib)->routes, (i)))
+
+static inline void *array_at(struct fib_array *a, uint32_t i)
+{
+	return a->items + (size_t)i * a->item_size;
+}
+
+static void array_init(struct fib_array *a, size_t item_size)
+{
+	memset(a, 0, sizeof(*a));
+	a->item_size = item_size;
+	a->count = 1;
+}
+
+static void array_release(struct fib_array *a)
+{
+	free(a->items);
+	array_init(a, a->item_size);
+}
+
+/* Make room for n more items, so that taking them moves nothing */
+static int array_reserve(struct fib_array *a, uint32_t n)
+{
+	uint64_t capacity = a->capacity;
+	char *items;
+	
+	if ((uint64_t)a->count + n <= a->capacity)
+		return 0;
+	
+	if (capacity < FIB_MIN_CAPACITY)
+		capacity = FIB_MIN_CAPACITY;
+	while (capacity < (uint64_t)a->count + n)
+		capacity *= 2;
+	if (capacity > UINT32_MAX)
+		capacity = UINT32_MAX;
+	if (capacity < (uint64_t)a->count + n)
+		return -ENOMEM;
+	
+	items = realloc(a->items, (size_t)capacity * a->item_size);
+	if (!items)
+		return -ENOMEM;
+	
+	a->items = items;
+	a->capacity = (uint32_t)capacity;
+	return 0;
+}
+
+/* Take a zeroed item, room for it reserved */
+static uint32_t array_alloc(struct fib_array *a)
+{
+	uint32_t i;
+	
+	if (a->free != FIB_NONE) {
+		i = a->free;
+		memcpy(&a->free, array_at(a, i), sizeof(a->free));
+	} else {
+		i = a->count++;
+	}
+	
+	memset(array_at(a, i), 0, a->item_size);
+	a->used++;
+	return i;
+}
+
+static void array_free(struct fib_array *a, uint32_t i)
+{
+	memcpy(array_at(a, i), &a->free, sizeof(a->free));
+	a->free = i;
+	a->used--;
+}
+
+static unsigned int family_bits(int family)
+{
+	switch (family) {
+	case AF_INET:
+		return 32;
+	case AF_INET6:
+		return 128;
+	default:
+		return 0;
+	}
+}
+
+static inline unsigned int key_bit(const uint8_t *key, unsigned int bit)
+{
+	return (key[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+/* Clear the bits past len */
+static void key_mask(uint8_t *key, unsigned int len)
+{
+	unsigned int i = len >> 3;
+	
+	if (len & 7)
+		key[i++] &= (uint8_t)(0xff << (8 - (len & 7)));
+	if (i < 16)
+		memset(key + i, 0, 16 - i);
+}
+
+/* Leading bits a and b have in common, at most max */
+static unsigned int match_len(const uint8_t *a, const uint8_t *b, unsigned int max)
+{
+	unsigned int i, n = 0;
+	uint8_t diff;
+	
+	for (i = 0; n < max; i++, n += 8) {
+		diff = a[i] ^ b[i];
+		if (diff) {
+			n += (unsigned int)__builtin_clz(diff) - 24;
+			break;
+		}
+	}
+	
+	return n < max ? n : max;
+}
+
+/* Prefix of an address string, an empty one is the default route's */
+static int parse_prefix(int family, const char *addr, unsigned int len, uint8_t *key)
+{
+	unsigned int bits = family_bits(family);
+	
+	memset(key, 0, 16);
+	if (!bits || len > bits)
+		return -EINVAL;
+	if (addr && addr[0] && inet_pton(family, addr, key) != 1)
+		return -EINVAL;
+	
+	key_mask(key, len);
+	return 0;
+}
+
+static struct fib_trie *trie_get(struct fib_mirror *fib, unsigned int table, int family,
+                                 bool create)
+{
+	struct fib_trie *trie;
+	
+	for (trie = fib->tries; trie; trie = trie->next) {
+		if (trie->table == table && trie->family == family)
+			return trie;
+	}
+	
+	if (!create)
+		return NULL;
+	
+	trie = calloc(1, sizeof(*trie));
+	if (!trie)
+		return NULL;
+	
+	trie->table = table;
+	trie->family = family;
+	trie->next = fib->tries;
+	fib->tries = trie;
+	return trie;
+}
+
+/* Node of exactly key/plen, FIB_NONE if there is none */
+static uint32_t trie_find(struct fib_mirror *fib, struct fib_trie *trie,
+                          const uint8_t *key, unsigned int plen)
+{
+	struct fib_node *n;
+	uint32_t i = trie->root;
+	
+	while (i != FIB_NONE) {
+		n = NODE(fib, i);
+		if (n->plen > plen || match_len(n->key, key, n->plen) < n->plen)
+			return FIB_NONE;
+		if (n->plen == plen)
+			return i;
+		i = n->child[key_bit(key, n->plen)];
+	}
+	
+	return FIB_NONE;
+}
+
+/* Node of key/plen, created if need be, room for two nodes reserved */
+static uint32_t trie_insert(struct fib_mirror *fib, struct fib_trie *trie,
+                            const uint8_t *key, unsigned int plen)
+{
+	uint32_t *link = &trie->root;
+	uint32_t leaf, glue;
+	struct fib_node *n, *g;
+	unsigned int common;
+	
+	while (*link != FIB_NONE) {
+		n = NODE(fib, *link);
+		common = match_len(n->key, key, n->plen < plen ? n->plen : plen);
+		
+		if (common < n->plen) {
+			/* The node's prefix parts from ours, split it at the common bits */
+			leaf = array_alloc(&fib->nodes);
+			memcpy(NODE(fib, leaf)->key, key, 16);
+			NODE(fib, leaf)->plen = (uint8_t)plen;
+			
+			if (common == plen) {
+				/* Ours is a prefix of the node's */
+				NODE(fib, leaf)->child[key_bit(n->key, plen)] = *link;
+				*link = leaf;
+				return leaf;
+			}
+			
+			glue = array_alloc(&fib->nodes);
+			g = NODE(fib, glue);
+			memcpy(g->key, key, 16);
+			key_mask(g->key, common);
+			g->plen = (uint8_t)common;
+			g->child[key_bit(key, common)] = leaf;
+			g->child[key_bit(n->key, common)] = *link;
+			*link = glue;
+			return leaf;
+		}
+		
+		if (n->plen == plen)
+			return *link;
+		link = &n->child[key_bit(key, n->plen)];
+	}
+	
+	leaf = array_alloc(&fib->nodes);
+	memcpy(NODE(fib, leaf)->key, key, 16);
+	NODE(fib, leaf)->plen = (uint8_t)plen;
+	*link = leaf;
+	return leaf;
+}
+
+/* Remove the node of key/plen once it has no routes and parts nothing,
+ * with its parent if that is left parting nothing */
+static void trie_prune(struct fib_mirror *fib, struct fib_trie *trie,
+                       const uint8_t *key, unsigned int plen)
+{
+	uint32_t *links[FIB_MAX_BITS + 1];
+	uint32_t *link = &trie->root;
+	unsigned int depth = 0;
+	struct fib_node *n;
+	uint32_t i;
+	
+	while (*link != FIB_NONE) {
+		n = NODE(fib, *link);
+		if (n->plen > plen || match_len(n->key, key, n->plen) < n->plen)
+			return;
+		links[depth++] = link;
+		if (n->plen == plen)
+			break;
+		link = &n->child[key_bit(key, n->plen)];
+	}
+	
+	if (depth == 0 || NODE(fib, *links[depth - 1])->plen != plen)
+		return;
+	
+	while (depth > 0) {
+		link = links[--depth];
+		i = *link;
+		n = NODE(fib, i);
+		if (n->route != FIB_NONE ||
+		    (n->child[0] != FIB_NONE && n->child[1] != FIB_NONE))
+			return;
+		
+		*link = n->child[0] != FIB_NONE ? n->child[0] : n->child[1];
+		array_free(&fib->nodes, i);
+		
+		/* Only a node that lost its last child can make the parent redundant */
+		if (*link != FIB_NONE)
+			return;
+	}
+}
+
+/* Most specific node with routes on the path to key/plen, with strict only
+ * those of shorter prefixes */
+static uint32_t trie_match(struct fib_mirror *fib, struct fib_trie *trie,
+                           const uint8_t *key, unsigned int plen, bool strict)
+{
+	uint32_t best = FIB_NONE, i = trie->root;
+	struct fib_node *n;
+	
+	while (i != FIB_NONE) {
+		n = NODE(fib, i);
+		if (n->plen > plen || (strict && n->plen == plen) ||
+		    match_len(n->key, key, n->plen) < n->plen)
+			break;
+		if (n->route != FIB_NONE)
+			best = i;
+		if (n->plen == plen)
+			break;
+		i = n->child[key_bit(key, n->plen)];
+	}
+	
+	return best;
+}
+
+static void route_export(struct fib_mirror *fib, const struct fib_trie *trie, uint32_t node,
+                         uint32_t route, struct fib_mirror_route *out)
+{
+	const struct fib_node *n = NODE(fib, node);
+	const struct fib_route *r = ROUTE(fib, route);
+	
+	memset(out, 0, sizeof(*out));
+	out->family = trie->family;
+	out->table = trie->table;
+	out->dst_len = n->plen;
+	out->tos = r->tos;
+	out->protocol = r->protocol;
+	out->scope = r->scope;
+	out->type = r->type;
+	out->oif = (int)r->oif;
+	out->priority = r->priority;
+	out->since = r->since;
+	inet_ntop(trie->family, n->key, out->dst, sizeof(out->dst));
+	if (r->has_gateway)
+		inet_ntop(trie->family, r->gateway, out->gateway, sizeof(out->gateway));
+}
+
+/* Visit the routes of a subtree, false if @fn stopped the walk */
+static bool trie_walk(struct fib_mirror *fib, const struct fib_trie *trie, uint32_t top,
+                      fib_mirror_walk_fn fn, void *ctx, long *visited)
+{
+	uint32_t stack[FIB_MAX_BITS + 2];
+	struct fib_mirror_route out;
+	const struct fib_node *n;
+	unsigned int depth = 0;
+	uint32_t i, r;
+	
+	/* Preorder is address order, a path holds at most one pending sibling per node */
+	stack[depth++] = top;
+	while (depth > 0) {
+		i = stack[--depth];
+		n = NODE(fib, i);
+		
+		for (r = n->route; r != FIB_NONE; r = ROUTE(fib, r)->next) {
+			route_export(fib, trie, i, r, &out);
+			(*visited)++;
+			if (!fn(&out, ctx))
+				return false;
+		}
+		
+		if (n->child[1] != FIB_NONE)
+			stack[depth++] = n->child[1];
+		if (n->child[0] != FIB_NONE)
+			stack[depth++] = n->child[0];
+	}
+	
+	return true;
+}
+
+struct fib_mirror *fib_mirror_create(size_t max_routes)
+{
+	struct fib_mirror *fib;
+	
+	fib = calloc(1, sizeof(*fib));
+	if (!fib)
+		return NULL;
+	
+	if (pthread_rwlock_init(&fib->lock, NULL) != 0) {
+		free(fib);
+		return NULL;
+	}
+	
+	array_init(&fib->nodes, sizeof(struct fib_node));
+	array_init(&fib->routes, sizeof(struct fib_route));
+	fib->max_routes = max_routes;
+	return fib;
+}
+
+static void mirror_clear(struct fib_mirror *fib)
+{
+	struct fib_trie *trie, *next;
+	
+	for (trie = fib->tries; trie; trie = next) {
+		next = trie->next;
+		free(trie);
+	}
+	fib->tries = NULL;
+	
+	array_release(&fib->nodes);
+	array_release(&fib->routes);
+}
+
+void fib_mirror_destroy(struct fib_mirror *fib)
+{
+	if (!fib)
+		return;
+	
+	mirror_clear(fib);
+	pthread_rwlock_destroy(&fib->lock);
+	free(fib);
+}
+
+void fib_mirror_clear(struct fib_mirror *fib)
+{
+	if (!fib)
+		return;
+	
+	pthread_rwlock_wrlock(&fib->lock);
+	mirror_clear(fib);
+	pthread_rwlock_unlock(&fib->lock);
+}
+
+int fib_mirror_add(struct fib_mirror *fib, const struct nlmon_route_info *route, time_t now)
+{
+	uint8_t key[16], gateway[16] = { 0 };
+	bool has_gateway, changed;
+	struct fib_trie *trie;
+	struct fib_route *r;
+	uint32_t node, i, *link;
+	int ret;
+	
+	if (!fib || !route)
+		return -EINVAL;
+	if (parse_prefix(route->family, route->dst, route->dst_len, key) < 0)
+		return -EINVAL;
+	
+	has_gateway = route->gateway[0] != '\0';
+	if (has_gateway && inet_pton(route->family, route->gateway, gateway) != 1)
+		return -EINVAL;
+	
+	pthread_rwlock_wrlock(&fib->lock);
+	
+	trie = trie_get(fib, route->table, route->family, true);
+	if (!trie) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	
+	/* Room for a split and a route, nothing moves while linking */
+	if (array_reserve(&fib->nodes, 2) < 0 || array_reserve(&fib->routes, 1) < 0) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	
+	node = trie_insert(fib, trie, key, route->dst_len);
+	
+	for (link = &NODE(fib, node)->route; *link != FIB_NONE; link = &r->next) {
+		r = ROUTE(fib, *link);
+		if (r->priority > route->priority ||
+		    (r->priority == route->priority && r->tos >= route->tos))
+			break;
+	}
+	
+	r = *link != FIB_NONE ? ROUTE(fib, *link) : NULL;
+	if (r && r->priority == route->priority && r->tos == route->tos) {
+		changed = r->type != route->type || r->oif != (uint32_t)route->oif ||
+		          r->has_gateway != has_gateway ||
+		          memcmp(r->gateway, gateway, sizeof(gateway)) != 0;
+		ret = 1;
+	} else {
+		if (fib->max_routes && fib->routes.used >= fib->max_routes) {
+			trie_prune(fib, trie, key, route->dst_len);
+			ret = -ENOSPC;
+			goto out;
+		}
+		
+		i = array_alloc(&fib->routes);
+		r = ROUTE(fib, i);
+		r->next = *link;
+		r->priority = route->priority;
+		r->tos = route->tos;
+		*link = i;
+		changed = true;
+		ret = 0;
+	}
+	
+	memcpy(r->gateway, gateway, sizeof(gateway));
+	r->has_gateway = has_gateway;
+	r->protocol = route->protocol;
+	r->scope = route->scope;
+	r->type = route->type;
+	r->oif = (uint32_t)route->oif;
+	if (changed)
+		r->since = now;
+	
+out:
+	pthread_rwlock_unlock(&fib->lock);
+	return ret;
+}
+
+int fib_mirror_delete(struct fib_mirror *fib, const struct nlmon_route_info *route)
+{
+	struct fib_trie *trie;
+	struct fib_route *r;
+	uint32_t node, i, *link;
+	uint8_t key[16];
+	int ret = -ENOENT;
+	
+	if (!fib || !route)
+		return -EINVAL;
+	if (parse_prefix(route->family, route->dst, route->dst_len, key) < 0)
+		return -EINVAL;
+	
+	pthread_rwlock_wrlock(&fib->lock);
+	
+	trie = trie_get(fib, route->table, route->family, false);
+	node = trie ? trie_find(fib, trie, key, route->dst_len) : FIB_NONE;
+	if (node == FIB_NONE)
+		goto out;
+	
+	for (link = &NODE(fib, node)->route; *link != FIB_NONE; link = &r->next) {
+		r = ROUTE(fib, *link);
+		if (r->priority == route->priority && r->tos == route->tos) {
+			i = *link;
+			*link = r->next;
+			array_free(&fib->routes, i);
+			ret = 0;
+			break;
+		}
+	}
+	
+	if (ret == 0 && NODE(fib, node)->route == FIB_NONE)
+		trie_prune(fib, trie, key, route->dst_len);
+	
+out:
+	pthread_rwlock_unlock(&fib->lock);
+	return ret;
+}
+
+bool fib_mirror_find(struct fib_mirror *fib, const struct nlmon_route_info *route,
+                     struct fib_mirror_route *out)
+{
+	struct fib_trie *trie;
+	uint32_t node, i;
+	uint8_t key[16];
+	bool found = false;
+	
+	if (!fib || !route || !out)
+		return false;
+	if (parse_prefix(route->family, route->dst, route->dst_len, key) < 0)
+		return false;
+	
+	pthread_rwlock_rdlock(&fib->lock);
+	
+	trie = trie_get(fib, route->table, route->family, false);
+	node = trie ? trie_find(fib, trie, key, route->dst_len) : FIB_NONE;
+	for (i = node != FIB_NONE ? NODE(fib, node)->route : FIB_NONE; i != FIB_NONE;
+	     i = ROUTE(fib, i)->next) {
+		if (ROUTE(fib, i)->priority == route->priority && ROUTE(fib, i)->tos == route->tos) {
+			route_export(fib, trie, node, i, out);
+			found = true;
+			break;
+		}
+	}
+	
+	pthread_rwlock_unlock(&fib->lock);
+	return found;
+}
+
+bool fib_mirror_covering(struct fib_mirror *fib, const struct nlmon_route_info *route,
+                         struct fib_mirror_route *out)
+{
+	struct fib_trie *trie;
+	uint8_t key[16];
+	uint32_t node;
+	
+	if (!fib || !route || !out)
+		return false;
+	if (parse_prefix(route->family, route->dst, route->dst_len, key) < 0)
+		return false;
+	
+	pthread_rwlock_rdlock(&fib->lock);
+	
+	trie = trie_get(fib, route->table, route->family, false);
+	node = trie ? trie_match(fib, trie, key, route->dst_len, true) : FIB_NONE;
+	if (node != FIB_NONE)
+		route_export(fib, trie, node, NODE(fib, node)->route, out);
+	
+	pthread_rwlock_unlock(&fib->lock);
+	return node != FIB_NONE;
+}
+
+bool fib_mirror_lookup(struct fib_mirror *fib, unsigned int table, const char *addr,
+                       struct fib_mirror_route *out)
+{
+	struct fib_trie *trie;
+	uint8_t key[16];
+	uint32_t node;
+	int family;
+	
+	if (!fib || !addr || !out)
+		return false;
+	
+	family = strchr(addr, ':') ? AF_INET6 : AF_INET;
+	if (!addr[0] || parse_prefix(family, addr, family_bits(family), key) < 0)
+		return false;
+	
+	pthread_rwlock_rdlock(&fib->lock);
+	
+	trie = trie_get(fib, table, family, false);
+	node = trie ? trie_match(fib, trie, key, family_bits(family), false) : FIB_NONE;
+	if (node != FIB_NONE)
+		route_export(fib, trie, node, NODE(fib, node)->route, out);
+	
+	pthread_rwlock_unlock(&fib->lock);
+	return node != FIB_NONE;
+}
+
+long fib_mirror_walk(struct fib_mirror *fib, unsigned int table, int family,
+                     const char *prefix, unsigned int prefix_len,
+                     fib_mirror_walk_fn fn, void *ctx)
+{
+	struct fib_trie *trie;
+	struct fib_node *n;
+	uint8_t key[16];
+	uint32_t i;
+	long visited = 0;
+	
+	if (!fib || !fn)
+		return -EINVAL;
+	if (!prefix)
+		prefix_len = 0;
+	if (parse_prefix(family, prefix, prefix_len, key) < 0)
+		return -EINVAL;
+	
+	pthread_rwlock_rdlock(&fib->lock);
+	
+	/* Top of the subtree of routes inside the prefix */
+	trie = trie_get(fib, table, family, false);
+	i = trie ? trie->root : FIB_NONE;
+	while (i != FIB_NONE) {
+		n = NODE(fib, i);
+		if (n->plen >= prefix_len) {
+			if (match_len(n->key, key, prefix_len) < prefix_len)
+				i = FIB_NONE;
+			break;
+		}
+		if (match_len(n->key, key, n->plen) < n->plen) {
+			i = FIB_NONE;
+			break;
+		}
+		i = n->child[key_bit(key, n->plen)];
+	}
+	
+	if (i != FIB_NONE)
+		trie_walk(fib, trie, i, fn, ctx, &visited);
+	
+	pthread_rwlock_unlock(&fib->lock);
+	return visited;
+}
+
+long fib_mirror_walk_all(struct fib_mirror *fib, fib_mirror_walk_fn fn, void *ctx)
+{
+	struct fib_trie *trie;
+	long visited = 0;
+	
+	if (!fib || !fn)
+		return -EINVAL;
+	
+	pthread_rwlock_rdlock(&fib->lock);
+	for (trie = fib->tries; trie; trie = trie->next) {
+		if (trie->root != FIB_NONE && !trie_walk(fib, trie, trie->root, fn, ctx, &visited))
+			break;
+	}
+	pthread_rwlock_unlock(&fib->lock);
+	
+	return visited;
+}
+
+int fib_mirror_restore(struct fib_mirror *fib, const struct fib_mirror_route *route)
+{
+	struct nlmon_route_info info;
+	
+	if (!fib || !route)
+		return -EINVAL;
+	
+	memset(&info, 0, sizeof(info));
+	info.family = route->family;
+	info.table = route->table;
+	info.dst_len = route->dst_len;
+	info.tos = route->tos;
+	info.protocol = route->protocol;
+	info.scope = route->scope;
+	info.type = route->type;
+	info.oif = route->oif;
+	info.priority = route->priority;
+	memcpy(info.dst, route->dst, sizeof(info.dst));
+	memcpy(info.gateway, route->gateway, sizeof(info.gateway));
+	
+	/* A new route takes the time it is added at */
+	return fib_mirror_add(fib, &info, route->since);
+}
+
+void fib_mirror_stats(struct fib_mirror *fib, size_t *routes, size_t *nodes, size_t *bytes)
+{
+	if (!fib)
+		return;
+	
+	pthread_rwlock_rdlock(&fib->lock);
+	if (routes)
+		*routes = fib->routes.used;
+	if (nodes)
+		*nodes = fib->nodes.used;
+	if (bytes)
+		*bytes = (size_t)fib->nodes.capacity * fib->nodes.item_size +
+		         (size_t)fib->routes.capacity * fib->routes.item_size;
+	pthread_rwlock_unlock(&fib->lock);
+}
@@ -0,0 +1,232 @@
+/* filter_ac.c - Multi-pattern substring matching for filters
+ *
+ * The automaton is a complete DFA over byte classes: bytes in no pattern
+ * share class 0, which always leads back to the root, so the transition
+ * table stays small. Each state records the pattern ending there and a
+ * link to the next shorter state on its failure chain that ends one.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "filter_ac.h"
+
+struct ac_pattern {
+	char *str;
+	size_t len;
+};
+
+struct filter_ac {
+	struct ac_pattern *patterns;
+	size_t pattern_count;
+	size_t pattern_capacity;
+	
+	/* Built automaton */
+	uint16_t classes[256];
+	size_t class_count;
+	int32_t *next;                  /* state * class_count + class */
+	int32_t *output;                /* Pattern ending at a state, or -1 */
+	int32_t *dict;                  /* Next state with an output, or -1 */
+	size_t state_count;
+};
+
+bool filter_ac_literal(const char *pattern, size_t len, char *out, size_t *out_len)
+{
+	size_t n = 0;
+	
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = (unsigned char)pattern[i];
+		
+		if (c == '\\') {
+			if (++i >= len)
+				return false;
+			c = (unsigned char)pattern[i];
+			
+			/* Escaped letters, digits and these are GNU operators */
+			if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+			    (c >= '0' && c <= '9') || strchr("<>'`", c))
+				return false;
+		} else if (strchr(".[]()*+?{}|^$", c)) {
+			return false;
+		}
+		
+		out[n++] = (char)c;
+	}
+	
+	*out_len = n;
+	return n > 0;
+}
+
+struct filter_ac *filter_ac_create(void)
+{
+	return calloc(1, sizeof(struct filter_ac));
+}
+
+static void ac_free_automaton(struct filter_ac *ac)
+{
+	free(ac->next);
+	free(ac->output);
+	free(ac->dict);
+	ac->next = NULL;
+	ac->output = NULL;
+	ac->dict = NULL;
+	ac->state_count = 0;
+}
+
+void filter_ac_destroy(struct filter_ac *ac)
+{
+	if (!ac)
+		return;
+	
+	for (size_t i = 0; i < ac->pattern_count; i++)
+		free(ac->patterns[i].str);
+	free(ac->patterns);
+	ac_free_automaton(ac);
+	free(ac);
+}
+
+int filter_ac_add(struct filter_ac *ac, const char *pattern, size_t len)
+{
+	struct ac_pattern *p;
+	
+	if (!ac || !pattern || len == 0)
+		return -1;
+	
+	for (size_t i = 0; i < ac->pattern_count; i++) {
+		p = &ac->patterns[i];
+		if (p->len == len && memcmp(p->str, pattern, len) == 0)
+			return (int)i;
+	}
+	
+	if (ac->pattern_count == ac->pattern_capacity) {
+		size_t cap = ac->pattern_capacity ? ac->pattern_capacity * 2 : 16;
+		
+		p = realloc(ac->patterns, cap * sizeof(*ac->patterns));
+		if (!p)
+			return -1;
+		ac->patterns = p;
+		ac->pattern_capacity = cap;
+	}
+	
+	p = &ac->patterns[ac->pattern_count];
+	p->str = malloc(len);
+	if (!p->str)
+		return -1;
+	memcpy(p->str, pattern, len);
+	p->len = len;
+	
+	return (int)ac->pattern_count++;
+}
+
+bool filter_ac_build(struct filter_ac *ac)
+{
+	size_t max_states = 1, states = 1;
+	int32_t *fail, *queue;
+	size_t head = 0, tail = 0;
+	
+	if (!ac)
+		return false;
+	
+	ac_free_automaton(ac);
+	
+	/* Byte classes of all pattern bytes */
+	memset(ac->classes, 0, sizeof(ac->classes));
+	ac->class_count = 1;
+	for (size_t i = 0; i < ac->pattern_count; i++) {
+		for (size_t j = 0; j < ac->patterns[i].len; j++) {
+			unsigned char c = (unsigned char)ac->patterns[i].str[j];
+			
+			if (ac->classes[c] == 0)
+				ac->classes[c] = (uint16_t)ac->class_count++;
+		}
+		max_states += ac->patterns[i].len;
+	}
+	
+	ac->next = malloc(max_states * ac->class_count * sizeof(*ac->next));
+	ac->output = malloc(max_states * sizeof(*ac->output));
+	ac->dict = malloc(max_states * sizeof(*ac->dict));
+	fail = malloc(max_states * sizeof(*fail));
+	queue = malloc(max_states * sizeof(*queue));
+	if (!ac->next || !ac->output || !ac->dict || !fail || !queue) {
+		ac_free_automaton(ac);
+		free(fail);
+		free(queue);
+		return false;
+	}
+	
+	for (size_t i = 0; i < max_states * ac->class_count; i++)
+		ac->next[i] = -1;
+	for (size_t i = 0; i < max_states; i++)
+		ac->output[i] = -1;
+	
+	/* Trie */
+	for (size_t i = 0; i < ac->pattern_count; i++) {
+		int32_t state = 0;
+		
+		for (size_t j = 0; j < ac->patterns[i].len; j++) {
+			size_t c = ac->classes[(unsigned char)ac->patterns[i].str[j]];
+			int32_t *slot = &ac->next[state * ac->class_count + c];
+			
+			if (*slot < 0)
+				*slot = (int32_t)states++;
+			state = *slot;
+		}
+		ac->output[state] = (int32_t)i;
+	}
+	
+	/* Failure links breadth first, completing the transitions */
+	fail[0] = 0;
+	ac->dict[0] = -1;
+	for (size_t c = 0; c < ac->class_count; c++) {
+		int32_t *slot = &ac->next[c];
+		
+		if (*slot < 0 || c == 0) {
+			*slot = 0;
+		} else {
+			fail[*slot] = 0;
+			ac->dict[*slot] = -1;
+			queue[tail++] = *slot;
+		}
+	}
+	
+	while (head < tail) {
+		int32_t state = queue[head++];
+		
+		for (size_t c = 0; c < ac->class_count; c++) {
+			int32_t *slot = &ac->next[state * ac->class_count + c];
+			int32_t target = ac->next[fail[state] * ac->class_count + c];
+			
+			if (*slot < 0) {
+				*slot = target;
+				continue;
+			}
+			
+			fail[*slot] = target;
+			ac->dict[*slot] = ac->output[target] >= 0 ? target : ac->dict[target];
+			queue[tail++] = *slot;
+		}
+	}
+	
+	free(fail);
+	free(queue);
+	ac->state_count = states;
+	return true;
+}
+
+void filter_ac_scan(const struct filter_ac *ac, const char *text, size_t len,
+                    filter_ac_hit_fn hit, void *arg)
+{
+	int32_t state = 0;
+	
+	if (!ac || !ac->next)
+		return;
+	
+	for (size_t i = 0; i < len; i++) {
+		size_t c = ac->classes[(unsigned char)text[i]];
+		
+		state = ac->next[state * ac->class_count + c];
+		
+		for (int32_t s = ac->output[state] >= 0 ? state : ac->dict[state];
+		     s >= 0; s = ac->dict[s])
+			hit((uint32_t)ac->output[s], arg);
+	}
+}
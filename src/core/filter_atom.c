@@ -0,0 +1,262 @@
+/* filter_atom.c - Interned strings for filter evaluation
+ *
+ * The table is open addressed and kept at most half full. Interning
+ * takes a lock, lookups only read published slots. A table replaced by
+ * a bigger one may still be read by a concurrent lookup, so it is kept
+ * on a retired list until filter_atom_cleanup().
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "filter_atom.h"
+
+#define ATOM_TABLE_INITIAL 64
+
+struct atom_entry {
+	uint32_t hash;
+	uint32_t id;
+	size_t len;
+	char str[];
+};
+
+struct atom_table {
+	size_t mask;
+	struct atom_table *retired;     /* Older, smaller tables */
+	_Atomic(struct atom_entry *) slots[];
+};
+
+static _Atomic(struct atom_table *) atom_table;
+static pthread_mutex_t atom_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic uint32_t atom_count;
+
+/* FNV-1a */
+static uint32_t atom_hash(const char *str, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)str[i];
+		hash *= 16777619u;
+	}
+	
+	return hash;
+}
+
+/* Spread atom ids over set slots */
+static uint32_t atom_set_hash(uint32_t atom)
+{
+	return atom * 2654435761u;
+}
+
+static struct atom_table *atom_table_alloc(size_t size)
+{
+	struct atom_table *table;
+	
+	table = calloc(1, sizeof(*table) + size * sizeof(table->slots[0]));
+	if (!table)
+		return NULL;
+	
+	table->mask = size - 1;
+	return table;
+}
+
+static uint32_t atom_table_find(struct atom_table *table, const char *str,
+                                size_t len, uint32_t hash)
+{
+	struct atom_entry *entry;
+	size_t i = hash & table->mask;
+	
+	while ((entry = atomic_load_explicit(&table->slots[i], memory_order_acquire))) {
+		if (entry->hash == hash && entry->len == len &&
+		    memcmp(entry->str, str, len) == 0)
+			return entry->id;
+		i = (i + 1) & table->mask;
+	}
+	
+	return FILTER_ATOM_ABSENT;
+}
+
+static void atom_table_insert(struct atom_table *table, struct atom_entry *entry)
+{
+	size_t i = entry->hash & table->mask;
+	
+	while (atomic_load_explicit(&table->slots[i], memory_order_relaxed))
+		i = (i + 1) & table->mask;
+	
+	atomic_store_explicit(&table->slots[i], entry, memory_order_release);
+}
+
+/* Double the table, called with atom_lock held */
+static struct atom_table *atom_table_grow(struct atom_table *old)
+{
+	struct atom_table *table;
+	struct atom_entry *entry;
+	
+	table = atom_table_alloc(old ? (old->mask + 1) * 2 : ATOM_TABLE_INITIAL);
+	if (!table)
+		return NULL;
+	
+	if (old) {
+		for (size_t i = 0; i <= old->mask; i++) {
+			entry = atomic_load_explicit(&old->slots[i], memory_order_relaxed);
+			if (entry)
+				atom_table_insert(table, entry);
+		}
+		table->retired = old;
+	}
+	
+	atomic_store_explicit(&atom_table, table, memory_order_release);
+	return table;
+}
+
+uint32_t filter_atom_intern(const char *str, size_t len)
+{
+	struct atom_table *table;
+	struct atom_entry *entry;
+	uint32_t hash = atom_hash(str, len);
+	uint32_t count, id;
+	
+	pthread_mutex_lock(&atom_lock);
+	
+	table = atomic_load_explicit(&atom_table, memory_order_relaxed);
+	if (table) {
+		id = atom_table_find(table, str, len, hash);
+		if (id != FILTER_ATOM_ABSENT)
+			goto out;
+	}
+	
+	id = FILTER_ATOM_NONE;
+	count = atomic_load_explicit(&atom_count, memory_order_relaxed);
+	
+	/* Ids run from 1 and must never reach FILTER_ATOM_ABSENT */
+	if (count >= FILTER_ATOM_ABSENT - 1)
+		goto out;
+	
+	if (!table || ((size_t)count + 1) * 2 > table->mask + 1) {
+		table = atom_table_grow(table);
+		if (!table)
+			goto out;
+	}
+	
+	entry = malloc(sizeof(*entry) + len + 1);
+	if (!entry)
+		goto out;
+	
+	memcpy(entry->str, str, len);
+	entry->str[len] = '\0';
+	entry->len = len;
+	entry->hash = hash;
+	entry->id = count + 1;
+	
+	atom_table_insert(table, entry);
+	
+	/* Publish after the slot so a lookup that missed sees a new generation */
+	atomic_store_explicit(&atom_count, entry->id, memory_order_release);
+	id = entry->id;
+	
+out:
+	pthread_mutex_unlock(&atom_lock);
+	return id;
+}
+
+uint32_t filter_atom_lookup(const char *str, size_t len)
+{
+	struct atom_table *table = atomic_load_explicit(&atom_table, memory_order_acquire);
+	
+	if (!table)
+		return FILTER_ATOM_ABSENT;
+	
+	return atom_table_find(table, str, len, atom_hash(str, len));
+}
+
+uint32_t filter_atom_generation(void)
+{
+	return atomic_load_explicit(&atom_count, memory_order_acquire);
+}
+
+void filter_atom_cleanup(void)
+{
+	struct atom_table *table, *retired;
+	struct atom_entry *entry;
+	
+	pthread_mutex_lock(&atom_lock);
+	
+	table = atomic_exchange(&atom_table, NULL);
+	if (table) {
+		for (size_t i = 0; i <= table->mask; i++) {
+			entry = atomic_load_explicit(&table->slots[i], memory_order_relaxed);
+			free(entry);
+		}
+	}
+	
+	while (table) {
+		retired = table->retired;
+		free(table);
+		table = retired;
+	}
+	
+	atomic_store(&atom_count, 0);
+	pthread_mutex_unlock(&atom_lock);
+}
+
+bool filter_atom_set_init(struct filter_atom_set *set, const uint32_t *atoms,
+                          size_t count)
+{
+	size_t size = 4;
+	
+	while (size < count * 2)
+		size *= 2;
+	
+	set->slots = calloc(size, sizeof(*set->slots));
+	if (!set->slots)
+		return false;
+	
+	set->mask = size - 1;
+	set->count = 0;
+	
+	for (size_t i = 0; i < count; i++) {
+		uint32_t slot = atom_set_hash(atoms[i]) & set->mask;
+		
+		if (atoms[i] == FILTER_ATOM_NONE || atoms[i] == FILTER_ATOM_ABSENT)
+			continue;
+		
+		while (set->slots[slot] != FILTER_ATOM_NONE && set->slots[slot] != atoms[i])
+			slot = (slot + 1) & set->mask;
+		
+		if (set->slots[slot] == FILTER_ATOM_NONE) {
+			set->slots[slot] = atoms[i];
+			set->count++;
+		}
+	}
+	
+	return true;
+}
+
+bool filter_atom_set_contains(const struct filter_atom_set *set, uint32_t atom)
+{
+	uint32_t slot;
+	
+	if (atom == FILTER_ATOM_NONE || atom == FILTER_ATOM_ABSENT)
+		return false;
+	
+	slot = atom_set_hash(atom) & set->mask;
+	while (set->slots[slot] != FILTER_ATOM_NONE) {
+		if (set->slots[slot] == atom)
+			return true;
+		slot = (slot + 1) & set->mask;
+	}
+	
+	return false;
+}
+
+void filter_atom_set_free(struct filter_atom_set *set)
+{
+	if (!set)
+		return;
+	
+	free(set->slots);
+	set->slots = NULL;
+	set->count = 0;
+}
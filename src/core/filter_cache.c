@@ -0,0 +1,606 @@
+/* filter_cache.c - Compiled filters shared by expression
+ *
+ * Keys, whether normalized texts or canonical forms, sit in one chained
+ * hash table under one lock, each pointing at its entry. Entries hold a
+ * reference to their bytecode and are kept in least recently used order;
+ * dropping one unlinks all of its keys. Misses compile under the lock, so
+ * concurrent requests for a new expression compile it once.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "filter_cache.h"
+#include "filter_parser.h"
+#include "filter_compiler.h"
+
+#define KEY_TABLE_INITIAL 64
+
+struct cache_entry;
+
+struct cache_key {
+	uint32_t hash;
+	bool canonical;                 /* Canonical form, else normalized text */
+	char *text;
+	struct cache_entry *entry;
+	struct cache_key *next;         /* Hash chain */
+	struct cache_key *sibling;      /* Next key of the same entry */
+};
+
+struct cache_entry {
+	struct filter_bytecode *bytecode;
+	struct cache_key *keys;
+	size_t aliases;
+	struct cache_entry *prev;       /* Toward the most recently used */
+	struct cache_entry *next;
+};
+
+static struct cache_key **key_table;
+static size_t key_table_size;
+static size_t key_count;
+static struct cache_entry *lru_head;   /* Most recently used */
+static struct cache_entry *lru_tail;
+static size_t entry_count;
+static size_t alias_count;
+static uint64_t stat_hits;
+static uint64_t stat_canonical_hits;
+static uint64_t stat_misses;
+static uint64_t stat_evictions;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Growable text of a canonical form */
+struct textbuf {
+	char *buf;
+	size_t len;
+	size_t cap;
+	bool failed;
+};
+
+static void text_append(struct textbuf *tb, const char *str, size_t len)
+{
+	if (tb->failed)
+		return;
+	
+	if (tb->len + len + 1 > tb->cap) {
+		size_t cap = tb->cap ? tb->cap : 64;
+		char *buf;
+	
+		while (cap < tb->len + len + 1)
+			cap *= 2;
+		buf = realloc(tb->buf, cap);
+		if (!buf) {
+			tb->failed = true;
+			return;
+		}
+		tb->buf = buf;
+		tb->cap = cap;
+	}
+	
+	memcpy(tb->buf + tb->len, str, len);
+	tb->len += len;
+	tb->buf[tb->len] = '\0';
+}
+
+static void text_printf(struct textbuf *tb, const char *fmt, ...)
+{
+	char small[64];
+	va_list ap;
+	int n;
+	
+	va_start(ap, fmt);
+	n = vsnprintf(small, sizeof(small), fmt, ap);
+	va_end(ap);
+	
+	if (n < 0 || (size_t)n >= sizeof(small))
+		tb->failed = true;
+	else
+		text_append(tb, small, (size_t)n);
+}
+
+static bool is_constant(const struct filter_node *node)
+{
+	return node->type == FILTER_NODE_STRING || node->type == FILTER_NODE_NUMBER;
+}
+
+/* Comparison with its operands swapped */
+static enum filter_node_type mirror(enum filter_node_type type)
+{
+	switch (type) {
+	case FILTER_NODE_LT: return FILTER_NODE_GT;
+	case FILTER_NODE_GT: return FILTER_NODE_LT;
+	case FILTER_NODE_LE: return FILTER_NODE_GE;
+	case FILTER_NODE_GE: return FILTER_NODE_LE;
+	default: return type;
+	}
+}
+
+static int compare_texts(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void canonical_form(struct textbuf *tb, const struct filter_node *node);
+
+/* Canonical form of a subtree on its own, NULL without memory */
+static char *canonical_text(const struct filter_node *node)
+{
+	struct textbuf tb = { 0 };
+	
+	canonical_form(&tb, node);
+	if (tb.failed || !tb.buf) {
+		free(tb.buf);
+		return NULL;
+	}
+	return tb.buf;
+}
+
+/* Append texts[0..count) in order, sorting the first sorted of them */
+static void append_sorted(struct textbuf *tb, char **texts, size_t count, size_t sorted)
+{
+	qsort(texts, sorted, sizeof(*texts), compare_texts);
+	for (size_t i = 0; i < count; i++) {
+		text_append(tb, " ", 1);
+		text_append(tb, texts[i], strlen(texts[i]));
+	}
+}
+
+/* Operands of an AND or OR chain, left to right */
+static size_t chain_operands(const struct filter_node *node, enum filter_node_type type,
+                             const struct filter_node **out, size_t n)
+{
+	if (node->type != type) {
+		out[n] = node;
+		return n + 1;
+	}
+	n = chain_operands(node->data.binary.left, type, out, n);
+	return chain_operands(node->data.binary.right, type, out, n);
+}
+
+static size_t chain_size(const struct filter_node *node, enum filter_node_type type)
+{
+	if (node->type != type)
+		return 1;
+	return chain_size(node->data.binary.left, type) + chain_size(node->data.binary.right, type);
+}
+
+/* Serialize a chain, operands before the first fallible one sorted */
+static void chain_form(struct textbuf *tb, const struct filter_node *node)
+{
+	size_t count = chain_size(node, node->type), sorted = 0;
+	const struct filter_node **operands = calloc(count, sizeof(*operands));
+	char **texts = calloc(count, sizeof(*texts));
+	
+	if (!operands || !texts) {
+		tb->failed = true;
+		goto out;
+	}
+	
+	chain_operands(node, node->type, operands, 0);
+	while (sorted < count && !filter_node_fallible(operands[sorted]))
+		sorted++;
+	for (size_t i = 0; i < count; i++) {
+		texts[i] = canonical_text(operands[i]);
+		if (!texts[i]) {
+			tb->failed = true;
+			goto out;
+		}
+	}
+	
+	text_printf(tb, "(%d", (int)node->type);
+	append_sorted(tb, texts, count, sorted);
+	text_append(tb, ")", 1);
+
+out:
+	for (size_t i = 0; texts && i < count; i++)
+		free(texts[i]);
+	free(texts);
+	free(operands);
+}
+
+/* Serialize a subtree, strings are length prefixed so any content is safe */
+static void canonical_form(struct textbuf *tb, const struct filter_node *node)
+{
+	const struct filter_node *left, *right;
+	enum filter_node_type type = node->type;
+	
+	switch (type) {
+	case FILTER_NODE_FIELD:
+		text_printf(tb, "f%d", (int)node->data.field.field);
+		break;
+	case FILTER_NODE_STRING:
+		text_printf(tb, "s%zu:", strlen(node->data.string.value));
+		text_append(tb, node->data.string.value, strlen(node->data.string.value));
+		break;
+	case FILTER_NODE_NUMBER:
+		text_printf(tb, "n%" PRId64, node->data.number.value);
+		break;
+	case FILTER_NODE_LIST: {
+		size_t count = node->data.list.count;
+		char **texts = calloc(count ? count : 1, sizeof(*texts));
+	
+		if (!texts) {
+			tb->failed = true;
+			break;
+		}
+		for (size_t i = 0; i < count && !tb->failed; i++) {
+			texts[i] = canonical_text(node->data.list.items[i]);
+			if (!texts[i])
+				tb->failed = true;
+		}
+		if (!tb->failed) {
+			text_append(tb, "[", 1);
+			append_sorted(tb, texts, count, count);
+			text_append(tb, "]", 1);
+		}
+		for (size_t i = 0; i < count; i++)
+			free(texts[i]);
+		free(texts);
+		break;
+	}
+	case FILTER_NODE_AND:
+	case FILTER_NODE_OR:
+		chain_form(tb, node);
+		break;
+	case FILTER_NODE_NOT:
+		text_printf(tb, "(%d ", (int)type);
+		canonical_form(tb, node->data.unary.operand);
+		text_append(tb, ")", 1);
+		break;
+	case FILTER_NODE_CALL:
+		/* Ids stay with their names, see filter_predicate.h */
+		text_printf(tb, "c%d(", node->data.call.predicate);
+		if (node->data.call.arg)
+			canonical_form(tb, node->data.call.arg);
+		text_append(tb, ")", 1);
+		break;
+	default:
+		left = node->data.binary.left;
+		right = node->data.binary.right;
+	
+		/* 5 < event_type is event_type > 5, patterns stay on the right */
+		if (type != FILTER_NODE_MATCH && type != FILTER_NODE_NMATCH &&
+		    type != FILTER_NODE_IN && is_constant(left) && right->type == FILTER_NODE_FIELD) {
+			left = right;
+			right = node->data.binary.left;
+			type = mirror(type);
+		}
+		text_printf(tb, "(%d ", (int)type);
+		canonical_form(tb, left);
+		text_append(tb, " ", 1);
+		canonical_form(tb, right);
+		text_append(tb, ")", 1);
+		break;
+	}
+}
+
+/* Expression with whitespace outside quotes collapsed, NULL without memory */
+static char *normalize_text(const char *expression)
+{
+	char *out = malloc(strlen(expression) + 1);
+	size_t len = 0;
+	char quote = 0;
+	bool space = false;
+	
+	if (!out)
+		return NULL;
+	
+	for (const char *p = expression; *p; p++) {
+		char c = *p;
+	
+		if (!quote && (c == ' ' || c == '\t' || c == '\r' || c == '\n')) {
+			space = len > 0;
+			continue;
+		}
+		if (space) {
+			out[len++] = ' ';
+			space = false;
+		}
+	
+		if (quote) {
+			if (c == '\\' && p[1]) {
+				out[len++] = c;
+				c = *++p;
+			} else if (c == quote) {
+				quote = 0;
+			}
+		} else if (c == '"' || c == '\'') {
+			quote = c;
+		}
+		out[len++] = c;
+	}
+	
+	out[len] = '\0';
+	return out;
+}
+
+/* FNV-1a */
+static uint32_t text_hash(const char *text)
+{
+	uint32_t hash = 2166136261u;
+	
+	for (const char *p = text; *p; p++) {
+		hash ^= (unsigned char)*p;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* Entry of a key, called with cache_lock held */
+static struct cache_entry *key_find(const char *text, uint32_t hash, bool canonical)
+{
+	struct cache_key *key;
+	
+	if (!key_table)
+		return NULL;
+	
+	for (key = key_table[hash & (key_table_size - 1)]; key; key = key->next) {
+		if (key->hash == hash && key->canonical == canonical && strcmp(key->text, text) == 0)
+			return key->entry;
+	}
+	return NULL;
+}
+
+/* Double the table, called with cache_lock held */
+static bool key_table_grow(void)
+{
+	size_t size = key_table_size ? key_table_size * 2 : KEY_TABLE_INITIAL;
+	struct cache_key **table, *key, *next;
+	
+	table = calloc(size, sizeof(*table));
+	if (!table)
+		return false;
+	
+	for (size_t i = 0; i < key_table_size; i++) {
+		for (key = key_table[i]; key; key = next) {
+			next = key->next;
+			key->next = table[key->hash & (size - 1)];
+			table[key->hash & (size - 1)] = key;
+		}
+	}
+	
+	free(key_table);
+	key_table = table;
+	key_table_size = size;
+	return true;
+}
+
+/* Add a key of entry, taking text, called with cache_lock held */
+static bool key_add(struct cache_entry *entry, char *text, uint32_t hash, bool canonical)
+{
+	struct cache_key *key;
+	size_t slot;
+	
+	if (key_count * 2 >= key_table_size && !key_table_grow())
+		return false;
+	
+	key = calloc(1, sizeof(*key));
+	if (!key)
+		return false;
+	
+	key->hash = hash;
+	key->canonical = canonical;
+	key->text = text;
+	key->entry = entry;
+	slot = hash & (key_table_size - 1);
+	key->next = key_table[slot];
+	key_table[slot] = key;
+	key->sibling = entry->keys;
+	entry->keys = key;
+	key_count++;
+	if (!canonical) {
+		entry->aliases++;
+		alias_count++;
+	}
+	return true;
+}
+
+static void lru_unlink(struct cache_entry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		lru_head = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		lru_tail = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+
+static void lru_push(struct cache_entry *entry)
+{
+	entry->next = lru_head;
+	if (lru_head)
+		lru_head->prev = entry;
+	lru_head = entry;
+	if (!lru_tail)
+		lru_tail = entry;
+}
+
+/* Mark an entry used and take a reference, called with cache_lock held */
+static struct filter_bytecode *entry_use(struct cache_entry *entry)
+{
+	if (entry != lru_head) {
+		lru_unlink(entry);
+		lru_push(entry);
+	}
+	return filter_bytecode_ref(entry->bytecode);
+}
+
+/* Drop an entry and its keys, called with cache_lock held */
+static void entry_drop(struct cache_entry *entry)
+{
+	struct cache_key *key, *sibling, **link;
+	
+	for (key = entry->keys; key; key = sibling) {
+		sibling = key->sibling;
+		for (link = &key_table[key->hash & (key_table_size - 1)]; *link != key;
+		     link = &(*link)->next)
+			;
+		*link = key->next;
+		key_count--;
+		if (!key->canonical)
+			alias_count--;
+		free(key->text);
+		free(key);
+	}
+	
+	lru_unlink(entry);
+	entry_count--;
+	filter_bytecode_free(entry->bytecode);
+	free(entry);
+}
+
+/* Entry compiled from expr under its canonical key, taking it, called with
+ * cache_lock held */
+static struct cache_entry *entry_create(const struct filter_expr *expr, char *canonical,
+                                        uint32_t hash)
+{
+	struct cache_entry *entry = calloc(1, sizeof(*entry));
+	
+	if (!entry) {
+		free(canonical);
+		return NULL;
+	}
+	
+	/* The compiler only reads the AST */
+	entry->bytecode = filter_compile((struct filter_expr *)expr);
+	if (!entry->bytecode || !key_add(entry, canonical, hash, true)) {
+		filter_bytecode_free(entry->bytecode);
+		free(canonical);
+		free(entry);
+		return NULL;
+	}
+	filter_bytecode_optimize(entry->bytecode);
+	
+	lru_push(entry);
+	entry_count++;
+	stat_misses++;
+	
+	while (entry_count > FILTER_CACHE_MAX) {
+		entry_drop(lru_tail);
+		stat_evictions++;
+	}
+	return entry;
+}
+
+/* Bytecode of a parsed expression, remembering alias for it (taken) */
+static struct filter_bytecode *get_parsed(const struct filter_expr *expr, char *alias)
+{
+	struct filter_bytecode *bytecode = NULL;
+	struct cache_entry *entry;
+	uint32_t hash, alias_hash = 0;
+	char *canonical;
+	
+	if (!expr || !expr->valid || !expr->ast) {
+		free(alias);
+		return NULL;
+	}
+	
+	canonical = canonical_text(expr->ast);
+	if (!canonical) {
+		free(alias);
+		return NULL;
+	}
+	hash = text_hash(canonical);
+	if (alias)
+		alias_hash = text_hash(alias);
+	
+	pthread_mutex_lock(&cache_lock);
+	
+	entry = key_find(canonical, hash, true);
+	if (entry) {
+		stat_canonical_hits++;
+		free(canonical);
+	} else {
+		entry = entry_create(expr, canonical, hash);
+		if (!entry)
+			goto out;
+	}
+	
+	/* Another thread may have added the alias meanwhile */
+	if (alias && entry->aliases < FILTER_CACHE_ALIASES &&
+	    !key_find(alias, alias_hash, false) && key_add(entry, alias, alias_hash, false))
+		alias = NULL;
+	bytecode = entry_use(entry);
+
+out:
+	pthread_mutex_unlock(&cache_lock);
+	free(alias);
+	return bytecode;
+}
+
+struct filter_bytecode *filter_cache_get(const char *expression,
+                                         struct filter_parse_error *error)
+{
+	struct filter_bytecode *bytecode;
+	struct filter_expr *expr;
+	struct cache_entry *entry;
+	uint32_t hash;
+	char *text;
+	
+	if (!expression)
+		return NULL;
+	
+	text = normalize_text(expression);
+	if (!text)
+		return NULL;
+	hash = text_hash(text);
+	
+	pthread_mutex_lock(&cache_lock);
+	entry = key_find(text, hash, false);
+	if (entry) {
+		stat_hits++;
+		bytecode = entry_use(entry);
+		pthread_mutex_unlock(&cache_lock);
+		free(text);
+		return bytecode;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	
+	expr = filter_parse(expression);
+	if (!expr || !expr->valid) {
+		if (error && expr)
+			*error = expr->error;
+		else if (error)
+			snprintf(error->message, sizeof(error->message), "Out of memory");
+		filter_expr_free(expr);
+		free(text);
+		return NULL;
+	}
+	
+	bytecode = get_parsed(expr, text);
+	filter_expr_free(expr);
+	return bytecode;
+}
+
+struct filter_bytecode *filter_cache_get_expr(const struct filter_expr *expr)
+{
+	return get_parsed(expr, NULL);
+}
+
+void filter_cache_get_stats(struct filter_cache_stats *stats)
+{
+	if (!stats)
+		return;
+	
+	pthread_mutex_lock(&cache_lock);
+	stats->entries = entry_count;
+	stats->aliases = alias_count;
+	stats->hits = stat_hits;
+	stats->canonical_hits = stat_canonical_hits;
+	stats->misses = stat_misses;
+	stats->evictions = stat_evictions;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+void filter_cache_clear(void)
+{
+	pthread_mutex_lock(&cache_lock);
+	while (lru_tail)
+		entry_drop(lru_tail);
+	pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,600 @@
+/* filter_cbpf.c - Classic BPF prefilter generation
+ *
+ * Lowers the fixed-offset subset of a filter expression to a classic BPF
+ * program for SO_ATTACH_FILTER, so messages the expression can never
+ * match are dropped in the kernel before they are copied to user space.
+ * Predicates that need parsed attributes are relaxed to "accept" and are
+ * left to the bytecode evaluator.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include "filter_compiler.h"
+#include "filter_parser.h"
+
+#define CBPF_NEXT    (-1)           /* Fall through to the next instruction */
+#define CBPF_ACCEPT  0xffffffffU    /* Return value keeping the whole packet */
+
+/* How much of an expression the kernel can evaluate */
+enum cbpf_fit {
+	CBPF_EXACT,     /* Fully evaluated in the kernel */
+	CBPF_RELAXED,   /* Kernel result is a superset of the real one */
+	CBPF_ANY,       /* Nothing evaluated, accept everything */
+};
+
+/* Where a header field is read from */
+enum cbpf_base {
+	CBPF_BASE_NLMSG,     /* struct nlmsghdr */
+	CBPF_BASE_GENL,      /* NETLINK_GENERIC messages only, 0 otherwise */
+	CBPF_BASE_PROTOCOL,  /* Netlink protocol of the socket or skb */
+};
+
+struct cbpf_field {
+	enum cbpf_base base;
+	uint32_t offset;
+	uint32_t size;
+};
+
+/* Program under construction, jump targets are symbolic labels */
+struct cbpf_builder {
+	struct sock_filter *insns;
+	int *jt_label;
+	int *jf_label;
+	size_t count;
+	size_t capacity;
+	
+	size_t *labels;
+	int label_count;
+	int label_capacity;
+	
+	int protocol;
+	bool failed;
+};
+
+static bool cbpf_field_lookup(enum filter_field_type field, struct cbpf_field *f)
+{
+	switch (field) {
+	case FILTER_FIELD_NL_PROTOCOL:
+		*f = (struct cbpf_field){ CBPF_BASE_PROTOCOL, 0, 2 };
+		return true;
+	case FILTER_FIELD_NL_MSG_TYPE:
+		*f = (struct cbpf_field){ CBPF_BASE_NLMSG,
+		                          offsetof(struct nlmsghdr, nlmsg_type), 2 };
+		return true;
+	case FILTER_FIELD_NL_MSG_FLAGS:
+		*f = (struct cbpf_field){ CBPF_BASE_NLMSG,
+		                          offsetof(struct nlmsghdr, nlmsg_flags), 2 };
+		return true;
+	case FILTER_FIELD_NL_SEQ:
+		*f = (struct cbpf_field){ CBPF_BASE_NLMSG,
+		                          offsetof(struct nlmsghdr, nlmsg_seq), 4 };
+		return true;
+	case FILTER_FIELD_NL_PID:
+		*f = (struct cbpf_field){ CBPF_BASE_NLMSG,
+		                          offsetof(struct nlmsghdr, nlmsg_pid), 4 };
+		return true;
+	case FILTER_FIELD_NL_GENL_CMD:
+		*f = (struct cbpf_field){ CBPF_BASE_GENL,
+		                          NLMSG_HDRLEN + offsetof(struct genlmsghdr, cmd), 1 };
+		return true;
+	case FILTER_FIELD_NL_GENL_VERSION:
+		*f = (struct cbpf_field){ CBPF_BASE_GENL,
+		                          NLMSG_HDRLEN + offsetof(struct genlmsghdr, version), 1 };
+		return true;
+	case FILTER_FIELD_NL_GENL_FAMILY_ID:
+		/* The family ID is the nlmsg_type of generic netlink messages */
+		*f = (struct cbpf_field){ CBPF_BASE_GENL,
+		                          offsetof(struct nlmsghdr, nlmsg_type), 2 };
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Constants wider than the field would be truncated to a different
+ * value, those comparisons are left to user space */
+static bool cbpf_constant_ok(const struct filter_node *node, const struct cbpf_field *f)
+{
+	return node && node->type == FILTER_NODE_NUMBER &&
+	       node->data.number.value >= 0 &&
+	       (uint64_t)node->data.number.value <= UINT64_MAX >> (64 - 8 * f->size);
+}
+
+static bool cbpf_field_ok(const struct filter_node *node, struct cbpf_field *f)
+{
+	return node && node->type == FILTER_NODE_FIELD &&
+	       cbpf_field_lookup(node->data.field.field, f);
+}
+
+/* Whether a comparison node is a field against numeric constant(s) */
+static bool cbpf_predicate_ok(const struct filter_node *node)
+{
+	const struct filter_node *l = node->data.binary.left;
+	const struct filter_node *r = node->data.binary.right;
+	struct cbpf_field f;
+	
+	if (node->type == FILTER_NODE_IN) {
+		if (!cbpf_field_ok(l, &f) || !r || r->type != FILTER_NODE_LIST)
+			return false;
+		for (size_t i = 0; i < r->data.list.count; i++) {
+			if (!cbpf_constant_ok(r->data.list.items[i], &f))
+				return false;
+		}
+		return true;
+	}
+	
+	return (cbpf_field_ok(l, &f) && cbpf_constant_ok(r, &f)) ||
+	       (cbpf_field_ok(r, &f) && cbpf_constant_ok(l, &f));
+}
+
+static enum cbpf_fit cbpf_classify(const struct filter_node *node)
+{
+	enum cbpf_fit l, r;
+	
+	if (!node)
+		return CBPF_ANY;
+	
+	switch (node->type) {
+	case FILTER_NODE_EQ:
+	case FILTER_NODE_NE:
+	case FILTER_NODE_LT:
+	case FILTER_NODE_GT:
+	case FILTER_NODE_LE:
+	case FILTER_NODE_GE:
+	case FILTER_NODE_IN:
+		return cbpf_predicate_ok(node) ? CBPF_EXACT : CBPF_ANY;
+	
+	case FILTER_NODE_AND:
+		l = cbpf_classify(node->data.binary.left);
+		r = cbpf_classify(node->data.binary.right);
+		if (l == CBPF_ANY && r == CBPF_ANY)
+			return CBPF_ANY;
+		if (l == CBPF_EXACT && r == CBPF_EXACT)
+			return CBPF_EXACT;
+		return CBPF_RELAXED;
+	
+	case FILTER_NODE_OR:
+		l = cbpf_classify(node->data.binary.left);
+		r = cbpf_classify(node->data.binary.right);
+		if (l == CBPF_ANY || r == CBPF_ANY)
+			return CBPF_ANY;
+		if (l == CBPF_EXACT && r == CBPF_EXACT)
+			return CBPF_EXACT;
+		return CBPF_RELAXED;
+	
+	case FILTER_NODE_NOT:
+		/* Negating a superset is not a superset of the negation */
+		return cbpf_classify(node->data.unary.operand) == CBPF_EXACT ?
+		       CBPF_EXACT : CBPF_ANY;
+	
+	default:
+		return CBPF_ANY;
+	}
+}
+
+/* Builder primitives */
+static void cbpf_emit_jump(struct cbpf_builder *b, uint16_t code, uint32_t k,
+                           int jt, int jf)
+{
+	if (b->failed)
+		return;
+	
+	if (b->count >= b->capacity) {
+		size_t new_capacity = b->capacity ? b->capacity * 2 : 64;
+		struct sock_filter *insns = realloc(b->insns, new_capacity * sizeof(*insns));
+		int *jt_label, *jf_label;
+	
+		if (!insns) {
+			b->failed = true;
+			return;
+		}
+		b->insns = insns;
+	
+		jt_label = realloc(b->jt_label, new_capacity * sizeof(*jt_label));
+		if (!jt_label) {
+			b->failed = true;
+			return;
+		}
+		b->jt_label = jt_label;
+	
+		jf_label = realloc(b->jf_label, new_capacity * sizeof(*jf_label));
+		if (!jf_label) {
+			b->failed = true;
+			return;
+		}
+		b->jf_label = jf_label;
+		b->capacity = new_capacity;
+	}
+	
+	b->insns[b->count] = (struct sock_filter)BPF_STMT(code, k);
+	b->jt_label[b->count] = jt;
+	b->jf_label[b->count] = jf;
+	b->count++;
+}
+
+static void cbpf_emit(struct cbpf_builder *b, uint16_t code, uint32_t k)
+{
+	cbpf_emit_jump(b, code, k, CBPF_NEXT, CBPF_NEXT);
+}
+
+static int cbpf_new_label(struct cbpf_builder *b)
+{
+	if (b->failed)
+		return CBPF_NEXT;
+	
+	if (b->label_count >= b->label_capacity) {
+		int new_capacity = b->label_capacity ? b->label_capacity * 2 : 16;
+		size_t *labels = realloc(b->labels, new_capacity * sizeof(*labels));
+	
+		if (!labels) {
+			b->failed = true;
+			return CBPF_NEXT;
+		}
+		b->labels = labels;
+		b->label_capacity = new_capacity;
+	}
+	
+	b->labels[b->label_count] = SIZE_MAX;
+	return b->label_count++;
+}
+
+static void cbpf_place(struct cbpf_builder *b, int label)
+{
+	if (!b->failed && label >= 0)
+		b->labels[label] = b->count;
+}
+
+/* Load a field into A in host byte order */
+static void cbpf_load_native(struct cbpf_builder *b, uint32_t offset, uint32_t size)
+{
+#if __BYTE_ORDER == __BIG_ENDIAN
+	cbpf_emit(b, BPF_LD | (size == 4 ? BPF_W : size == 2 ? BPF_H : BPF_B) | BPF_ABS,
+	          offset);
+#else
+	/* Classic BPF loads are big endian, assemble the value bytewise */
+	cbpf_emit(b, BPF_LD | BPF_B | BPF_ABS, offset + size - 1);
+	for (uint32_t i = size - 1; i > 0; i--) {
+		cbpf_emit(b, BPF_ALU | BPF_LSH | BPF_K, 8);
+		cbpf_emit(b, BPF_MISC | BPF_TAX, 0);
+		cbpf_emit(b, BPF_LD | BPF_B | BPF_ABS, offset + i - 1);
+		cbpf_emit(b, BPF_ALU | BPF_OR | BPF_X, 0);
+	}
+#endif
+}
+
+/* Load a field into A in network byte order, enough for equality tests */
+static void cbpf_load_raw(struct cbpf_builder *b, uint32_t offset, uint32_t size)
+{
+	cbpf_emit(b, BPF_LD | (size == 4 ? BPF_W : size == 2 ? BPF_H : BPF_B) | BPF_ABS,
+	          offset);
+}
+
+static void cbpf_load_proto(struct cbpf_builder *b)
+{
+	if (b->protocol >= 0)
+		cbpf_emit(b, BPF_LD | BPF_IMM, b->protocol);
+	else
+		/* nlmon sets skb->protocol to the tapped socket's protocol */
+		cbpf_emit(b, BPF_LD | BPF_H | BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL);
+}
+
+static void cbpf_load_field(struct cbpf_builder *b, const struct cbpf_field *f, bool raw)
+{
+	int zero, done;
+	
+	switch (f->base) {
+	case CBPF_BASE_PROTOCOL:
+		cbpf_load_proto(b);
+		return;
+	
+	case CBPF_BASE_NLMSG:
+		if (raw)
+			cbpf_load_raw(b, f->offset, f->size);
+		else
+			cbpf_load_native(b, f->offset, f->size);
+		return;
+	
+	case CBPF_BASE_GENL:
+		if (b->protocol >= 0 && b->protocol != NETLINK_GENERIC) {
+			cbpf_emit(b, BPF_LD | BPF_IMM, 0);
+			return;
+		}
+	
+		/* Non-genl or short messages read as 0, as in the parsed event */
+		zero = cbpf_new_label(b);
+		done = cbpf_new_label(b);
+		if (b->protocol < 0) {
+			cbpf_load_proto(b);
+			cbpf_emit_jump(b, BPF_JMP | BPF_JEQ | BPF_K, NETLINK_GENERIC,
+			               CBPF_NEXT, zero);
+		}
+		cbpf_emit(b, BPF_LD | BPF_W | BPF_LEN, 0);
+		cbpf_emit_jump(b, BPF_JMP | BPF_JGE | BPF_K, NLMSG_HDRLEN + GENL_HDRLEN,
+		               CBPF_NEXT, zero);
+		if (raw)
+			cbpf_load_raw(b, f->offset, f->size);
+		else
+			cbpf_load_native(b, f->offset, f->size);
+		cbpf_emit_jump(b, BPF_JMP | BPF_JA, 0, done, CBPF_NEXT);
+		cbpf_place(b, zero);
+		cbpf_emit(b, BPF_LD | BPF_IMM, 0);
+		cbpf_place(b, done);
+		return;
+	}
+}
+
+/* Constant in the byte order cbpf_load_field() left in A */
+static uint32_t cbpf_constant(const struct cbpf_field *f, int64_t value, bool raw)
+{
+	if (!raw || f->base == CBPF_BASE_PROTOCOL)
+		return (uint32_t)value;
+	if (f->size == 4)
+		return htonl((uint32_t)value);
+	if (f->size == 2)
+		return htons((uint16_t)value);
+	return (uint32_t)value;
+}
+
+static void cbpf_compile_compare(struct cbpf_builder *b, const struct filter_node *node,
+                                 int t, int f)
+{
+	const struct filter_node *field = node->data.binary.left;
+	const struct filter_node *literal = node->data.binary.right;
+	enum filter_node_type op = node->type;
+	struct cbpf_field desc;
+	bool raw;
+	uint32_t k;
+	
+	/* Normalize "constant op field" to "field op' constant" */
+	if (field->type != FILTER_NODE_FIELD) {
+		field = node->data.binary.right;
+		literal = node->data.binary.left;
+		switch (op) {
+		case FILTER_NODE_LT: op = FILTER_NODE_GT; break;
+		case FILTER_NODE_GT: op = FILTER_NODE_LT; break;
+		case FILTER_NODE_LE: op = FILTER_NODE_GE; break;
+		case FILTER_NODE_GE: op = FILTER_NODE_LE; break;
+		default: break;
+		}
+	}
+	
+	cbpf_field_lookup(field->data.field.field, &desc);
+	
+	/* Equality survives byte swapping, ordering needs host order */
+	raw = op == FILTER_NODE_EQ || op == FILTER_NODE_NE || op == FILTER_NODE_IN;
+	cbpf_load_field(b, &desc, raw);
+	
+	if (op == FILTER_NODE_IN) {
+		size_t count = literal->data.list.count;
+	
+		if (count == 0) {
+			cbpf_emit_jump(b, BPF_JMP | BPF_JA, 0, f, CBPF_NEXT);
+			return;
+		}
+		for (size_t i = 0; i < count; i++) {
+			k = cbpf_constant(&desc, literal->data.list.items[i]->data.number.value, raw);
+			cbpf_emit_jump(b, BPF_JMP | BPF_JEQ | BPF_K, k, t,
+			               i + 1 == count ? f : CBPF_NEXT);
+		}
+		return;
+	}
+	
+	k = cbpf_constant(&desc, literal->data.number.value, raw);
+	switch (op) {
+	case FILTER_NODE_EQ:
+		cbpf_emit_jump(b, BPF_JMP | BPF_JEQ | BPF_K, k, t, f);
+		break;
+	case FILTER_NODE_NE:
+		cbpf_emit_jump(b, BPF_JMP | BPF_JEQ | BPF_K, k, f, t);
+		break;
+	case FILTER_NODE_GT:
+		cbpf_emit_jump(b, BPF_JMP | BPF_JGT | BPF_K, k, t, f);
+		break;
+	case FILTER_NODE_GE:
+		cbpf_emit_jump(b, BPF_JMP | BPF_JGE | BPF_K, k, t, f);
+		break;
+	case FILTER_NODE_LT:
+		cbpf_emit_jump(b, BPF_JMP | BPF_JGE | BPF_K, k, f, t);
+		break;
+	case FILTER_NODE_LE:
+		cbpf_emit_jump(b, BPF_JMP | BPF_JGT | BPF_K, k, f, t);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Emit code jumping to label t when node may match and to f when it cannot */
+static void cbpf_compile_node(struct cbpf_builder *b, const struct filter_node *node,
+                              int t, int f)
+{
+	const struct filter_node *l, *r;
+	int next;
+	
+	if (cbpf_classify(node) == CBPF_ANY) {
+		cbpf_emit_jump(b, BPF_JMP | BPF_JA, 0, t, CBPF_NEXT);
+		return;
+	}
+	
+	switch (node->type) {
+	case FILTER_NODE_AND:
+		l = node->data.binary.left;
+		r = node->data.binary.right;
+		if (cbpf_classify(l) == CBPF_ANY) {
+			cbpf_compile_node(b, r, t, f);
+		} else if (cbpf_classify(r) == CBPF_ANY) {
+			cbpf_compile_node(b, l, t, f);
+		} else {
+			next = cbpf_new_label(b);
+			cbpf_compile_node(b, l, next, f);
+			cbpf_place(b, next);
+			cbpf_compile_node(b, r, t, f);
+		}
+		break;
+	
+	case FILTER_NODE_OR:
+		next = cbpf_new_label(b);
+		cbpf_compile_node(b, node->data.binary.left, t, next);
+		cbpf_place(b, next);
+		cbpf_compile_node(b, node->data.binary.right, t, f);
+		break;
+	
+	case FILTER_NODE_NOT:
+		cbpf_compile_node(b, node->data.unary.operand, f, t);
+		break;
+	
+	default:
+		cbpf_compile_compare(b, node, t, f);
+		break;
+	}
+}
+
+/* Turn labels into relative jump offsets */
+static int cbpf_resolve(struct cbpf_builder *b)
+{
+	if (b->count > BPF_MAXINSNS)
+		return -E2BIG;
+	
+	for (size_t i = 0; i < b->count; i++) {
+		struct sock_filter *insn = &b->insns[i];
+		int labels[2] = { b->jt_label[i], b->jf_label[i] };
+		size_t off[2] = { 0, 0 };
+	
+		if (BPF_CLASS(insn->code) != BPF_JMP)
+			continue;
+	
+		for (int j = 0; j < 2; j++) {
+			if (labels[j] == CBPF_NEXT)
+				continue;
+			/* Only forward jumps are emitted */
+			if (b->labels[labels[j]] == SIZE_MAX || b->labels[labels[j]] <= i)
+				return -EINVAL;
+			off[j] = b->labels[labels[j]] - (i + 1);
+		}
+	
+		if (BPF_OP(insn->code) == BPF_JA) {
+			insn->k = (uint32_t)off[0];
+			continue;
+		}
+		if (off[0] > UINT8_MAX || off[1] > UINT8_MAX)
+			return -E2BIG;
+		insn->jt = (uint8_t)off[0];
+		insn->jf = (uint8_t)off[1];
+	}
+	
+	return 0;
+}
+
+static void cbpf_builder_free(struct cbpf_builder *b)
+{
+	free(b->insns);
+	free(b->jt_label);
+	free(b->jf_label);
+	free(b->labels);
+}
+
+int filter_compile_cbpf(struct filter_expr *expr, int protocol,
+                        struct filter_cbpf **prog)
+{
+	struct cbpf_builder b;
+	struct filter_cbpf *out;
+	enum cbpf_fit fit;
+	int accept, drop;
+	int ret;
+	
+	if (!expr || !expr->valid || !expr->ast || !prog)
+		return -EINVAL;
+	
+	fit = cbpf_classify(expr->ast);
+	if (fit == CBPF_ANY)
+		return -ENOTSUP;
+	
+	memset(&b, 0, sizeof(b));
+	b.protocol = protocol;
+	accept = cbpf_new_label(&b);
+	drop = cbpf_new_label(&b);
+	
+	/* Runts are left for user space to report */
+	cbpf_emit(&b, BPF_LD | BPF_W | BPF_LEN, 0);
+	cbpf_emit_jump(&b, BPF_JMP | BPF_JGE | BPF_K, NLMSG_HDRLEN, CBPF_NEXT, accept);
+	
+	/* Only the first message of a datagram is visible, keep batches */
+	cbpf_load_native(&b, offsetof(struct nlmsghdr, nlmsg_len), 4);
+	cbpf_emit(&b, BPF_MISC | BPF_TAX, 0);
+	cbpf_emit(&b, BPF_LD | BPF_W | BPF_LEN, 0);
+	cbpf_emit(&b, BPF_ALU | BPF_SUB | BPF_X, 0);
+	cbpf_emit_jump(&b, BPF_JMP | BPF_JGT | BPF_K, NLMSG_ALIGNTO - 1, accept, CBPF_NEXT);
+	
+	/* Errors, acks and dump terminators */
+	cbpf_load_native(&b, offsetof(struct nlmsghdr, nlmsg_type), 2);
+	cbpf_emit_jump(&b, BPF_JMP | BPF_JGE | BPF_K, NLMSG_MIN_TYPE, CBPF_NEXT, accept);
+	
+	/* Multipart dump replies */
+	cbpf_load_raw(&b, offsetof(struct nlmsghdr, nlmsg_flags), 2);
+	cbpf_emit_jump(&b, BPF_JMP | BPF_JSET | BPF_K, htons(NLM_F_MULTI), accept, CBPF_NEXT);
+	
+	cbpf_compile_node(&b, expr->ast, accept, drop);
+	
+	cbpf_place(&b, drop);
+	cbpf_emit(&b, BPF_RET | BPF_K, 0);
+	cbpf_place(&b, accept);
+	cbpf_emit(&b, BPF_RET | BPF_K, CBPF_ACCEPT);
+	
+	if (b.failed) {
+		cbpf_builder_free(&b);
+		return -ENOMEM;
+	}
+	
+	ret = cbpf_resolve(&b);
+	if (ret < 0) {
+		cbpf_builder_free(&b);
+		return ret;
+	}
+	
+	out = calloc(1, sizeof(*out));
+	if (!out) {
+		cbpf_builder_free(&b);
+		return -ENOMEM;
+	}
+	
+	out->insns = b.insns;
+	out->len = (unsigned short)b.count;
+	out->relaxed = fit != CBPF_EXACT;
+	b.insns = NULL;
+	cbpf_builder_free(&b);
+	
+	*prog = out;
+	return 0;
+}
+
+void filter_cbpf_free(struct filter_cbpf *prog)
+{
+	if (!prog)
+		return;
+	
+	free(prog->insns);
+	free(prog);
+}
+
+int filter_cbpf_attach(int fd, const struct filter_cbpf *prog)
+{
+	struct sock_fprog fprog;
+	
+	if (fd < 0 || !prog || !prog->insns)
+		return -EINVAL;
+	
+	fprog.len = prog->len;
+	fprog.filter = prog->insns;
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0)
+		return -errno;
+	
+	return 0;
+}
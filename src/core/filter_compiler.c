@@ -6,8 +6,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdatomic.h>
 #include "filter_compiler.h"
 #include "filter_parser.h"
+#include "filter_jit.h"
+#include "filter_predicate.h"
 
 /* Helper functions for bytecode generation */
 static struct filter_bytecode *bytecode_create(void)
@@ -23,9 +26,16 @@ static struct filter_bytecode *bytecode_create(void)
 		return NULL;
 	}
 	
+	atomic_init(&bc->refs, 1);
+	
 	bc->string_capacity = 16;
 	bc->strings = malloc(bc->string_capacity * sizeof(char *));
-	if (!bc->strings) {
+	bc->string_lens = malloc(bc->string_capacity * sizeof(size_t));
+	bc->string_atoms = malloc(bc->string_capacity * sizeof(uint32_t));
+	if (!bc->strings || !bc->string_lens || !bc->string_atoms) {
+		free(bc->string_atoms);
+		free(bc->string_lens);
+		free(bc->strings);
 		free(bc->instructions);
 		free(bc);
 		return NULL;
@@ -52,9 +62,13 @@ static bool bytecode_emit(struct filter_bytecode *bc, struct filter_instruction
 
 static uint32_t bytecode_add_string(struct filter_bytecode *bc, const char *str)
 {
+	size_t len = strlen(str);
+	uint32_t atom = filter_atom_intern(str, len);
+	
 	/* Check if string already exists */
 	for (size_t i = 0; i < bc->string_count; i++) {
-		if (strcmp(bc->strings[i], str) == 0)
+		if (atom != FILTER_ATOM_NONE ? bc->string_atoms[i] == atom :
+		    strcmp(bc->strings[i], str) == 0)
 			return i;
 	}
 	
@@ -65,16 +79,64 @@ static uint32_t bytecode_add_string(struct filter_bytecode *bc, const char *str)
 		if (!new_strings)
 			return 0;
 		bc->strings = new_strings;
+		size_t *new_lens = realloc(bc->string_lens, new_capacity * sizeof(size_t));
+		if (!new_lens)
+			return 0;
+		bc->string_lens = new_lens;
+		uint32_t *new_atoms = realloc(bc->string_atoms, new_capacity * sizeof(uint32_t));
+		if (!new_atoms)
+			return 0;
+		bc->string_atoms = new_atoms;
 		bc->string_capacity = new_capacity;
 	}
 	
 	bc->strings[bc->string_count] = strdup(str);
 	if (!bc->strings[bc->string_count])
 		return 0;
+	bc->string_lens[bc->string_count] = len;
+	bc->string_atoms[bc->string_count] = atom;
 	
 	return bc->string_count++;
 }
 
+/* Add the atom set of an IN list of string constants */
+static bool bytecode_add_set(struct filter_bytecode *bc, struct filter_node *list,
+                             uint32_t *index)
+{
+	struct filter_atom_set *new_sets;
+	uint32_t *atoms;
+	bool ok;
+	
+	atoms = malloc(list->data.list.count * sizeof(*atoms));
+	if (!atoms)
+		return false;
+	
+	for (size_t i = 0; i < list->data.list.count; i++) {
+		const char *str = list->data.list.items[i]->data.string.value;
+		
+		atoms[i] = filter_atom_intern(str, strlen(str));
+		if (atoms[i] == FILTER_ATOM_NONE) {
+			free(atoms);
+			return false;
+		}
+	}
+	
+	new_sets = realloc(bc->sets, (bc->set_count + 1) * sizeof(*bc->sets));
+	if (!new_sets) {
+		free(atoms);
+		return false;
+	}
+	bc->sets = new_sets;
+	
+	ok = filter_atom_set_init(&bc->sets[bc->set_count], atoms, list->data.list.count);
+	free(atoms);
+	if (!ok)
+		return false;
+	
+	*index = bc->set_count++;
+	return true;
+}
+
 static bool compile_node_recursive(struct filter_node *node, struct filter_bytecode *bc);
 
 static bool compile_binary_op(struct filter_node *node, struct filter_bytecode *bc,
@@ -93,8 +155,88 @@ static bool compile_binary_op(struct filter_node *node, struct filter_bytecode *
 	return bytecode_emit(bc, instr);
 }
 
+static size_t chain_size(const struct filter_node *node, enum filter_node_type type)
+{
+	if (node->type != type)
+		return 1;
+	return chain_size(node->data.binary.left, type) + chain_size(node->data.binary.right, type);
+}
+
+static size_t chain_operands(struct filter_node *node, enum filter_node_type type,
+                             struct filter_node **out, size_t n)
+{
+	if (node->type != type) {
+		out[n] = node;
+		return n + 1;
+	}
+	n = chain_operands(node->data.binary.left, type, out, n);
+	return chain_operands(node->data.binary.right, type, out, n);
+}
+
+/*
+ * Compile an AND/OR chain left deep over its operands, with operands that
+ * call predicates moved behind the plain ones by their declared cost.
+ * Only operands in front of the first fallible one move, as in
+ * filter_profile.c, so which events fail to evaluate stays the same.
+ */
+static bool compile_chain(struct filter_node *node, struct filter_bytecode *bc,
+                          enum filter_opcode jump)
+{
+	size_t count = chain_size(node, node->type), movable = 0;
+	struct filter_node **operands = malloc(count * sizeof(*operands));
+	uint64_t *cost = malloc(count * sizeof(*cost));
+	bool ok = false;
+	
+	if (!operands || !cost)
+		goto out;
+	
+	chain_operands(node, node->type, operands, 0);
+	while (movable < count && !filter_node_fallible(operands[movable]))
+		movable++;
+	for (size_t i = 0; i < movable; i++)
+		cost[i] = filter_predicate_node_cost(operands[i]);
+	
+	/* Insertion sort keeps the written order among equal costs */
+	for (size_t i = 1; i < movable; i++) {
+		struct filter_node *op = operands[i];
+		uint64_t c = cost[i];
+		size_t j = i;
+		
+		for (; j > 0 && cost[j - 1] > c; j--) {
+			operands[j] = operands[j - 1];
+			cost[j] = cost[j - 1];
+		}
+		operands[j] = op;
+		cost[j] = c;
+	}
+	
+	/* The jump after operands [0, i) skips operand i, as for nested nodes */
+	if (!compile_node_recursive(operands[0], bc))
+		goto out;
+	for (size_t i = 1; i < count; i++) {
+		struct filter_instruction jump_instr = { .opcode = jump };
+		struct filter_instruction pop_instr = { .opcode = OP_POP };
+		size_t jump_pos = bc->instruction_count;
+		
+		if (!bytecode_emit(bc, jump_instr) || !bytecode_emit(bc, pop_instr) ||
+		    !compile_node_recursive(operands[i], bc))
+			goto out;
+		bc->instructions[jump_pos].operand.jump.offset = bc->instruction_count - jump_pos - 1;
+	}
+	ok = true;
+	
+out:
+	free(cost);
+	free(operands);
+	return ok;
+}
+
 static bool compile_logical_and(struct filter_node *node, struct filter_bytecode *bc)
 {
+	/* Chains calling predicates are scheduled as a whole */
+	if (filter_predicate_node_cost(node))
+		return compile_chain(node, bc, OP_JUMP_IF_FALSE);
+	
 	/* Compile left operand */
 	if (!compile_node_recursive(node->data.binary.left, bc))
 		return false;
@@ -122,6 +264,10 @@ static bool compile_logical_and(struct filter_node *node, struct filter_bytecode
 
 static bool compile_logical_or(struct filter_node *node, struct filter_bytecode *bc)
 {
+	/* Chains calling predicates are scheduled as a whole */
+	if (filter_predicate_node_cost(node))
+		return compile_chain(node, bc, OP_JUMP_IF_TRUE);
+	
 	/* Compile left operand */
 	if (!compile_node_recursive(node->data.binary.left, bc))
 		return false;
@@ -158,6 +304,21 @@ static bool compile_in_op(struct filter_node *node, struct filter_bytecode *bc)
 	if (list->type != FILTER_NODE_LIST)
 		return false;
 	
+	/* A list of string constants becomes one hash set probe */
+	bool all_strings = list->data.list.count > 0;
+	for (size_t i = 0; i < list->data.list.count; i++) {
+		if (list->data.list.items[i]->type != FILTER_NODE_STRING)
+			all_strings = false;
+	}
+	
+	if (all_strings) {
+		struct filter_instruction set_instr = { .opcode = OP_IN_SET };
+		
+		if (!bytecode_add_set(bc, list, &set_instr.operand.set.set_index))
+			return false;
+		return bytecode_emit(bc, set_instr);
+	}
+	
 	/* Compile each list item */
 	for (size_t i = 0; i < list->data.list.count; i++) {
 		if (!compile_node_recursive(list->data.list.items[i], bc))
@@ -239,6 +400,21 @@ static bool compile_node_recursive(struct filter_node *node, struct filter_bytec
 	case FILTER_NODE_LIST:
 		/* Lists are handled by IN operator */
 		return false;
+		
+	case FILTER_NODE_CALL:
+		instr.opcode = OP_CALL;
+		memset(&instr.operand.call, 0, sizeof(instr.operand.call));
+		instr.operand.call.predicate = node->data.call.predicate;
+		instr.operand.call.arg = FILTER_PREDICATE_ARG_NONE;
+		if (node->data.call.arg && node->data.call.arg->type == FILTER_NODE_STRING) {
+			instr.operand.call.arg = FILTER_PREDICATE_ARG_STRING;
+			instr.operand.call.string_index =
+				bytecode_add_string(bc, node->data.call.arg->data.string.value);
+		} else if (node->data.call.arg) {
+			instr.operand.call.arg = FILTER_PREDICATE_ARG_NUMBER;
+			instr.operand.call.number = node->data.call.arg->data.number.value;
+		}
+		return bytecode_emit(bc, instr);
 	}
 	
 	return false;
@@ -289,6 +465,161 @@ static size_t optimize_constant_folding(struct filter_bytecode *bc)
 	return optimizations;
 }
 
+/* Instruction a jump at pc leads to */
+static size_t jump_target(const struct filter_bytecode *bc, size_t pc)
+{
+	const struct filter_instruction *instr = &bc->instructions[pc];
+	int64_t target = (int64_t)pc + instr->operand.jump.offset;
+	
+	/* The interpreter advances past a conditional jump after taking it */
+	if (instr->opcode != OP_JUMP)
+		target++;
+	
+	return target < 0 ? SIZE_MAX : (size_t)target;
+}
+
+static bool is_jump(enum filter_opcode opcode)
+{
+	return opcode == OP_JUMP || opcode == OP_JUMP_IF_FALSE ||
+	       opcode == OP_JUMP_IF_TRUE;
+}
+
+static bool is_compare(enum filter_opcode opcode)
+{
+	return opcode >= OP_EQ && opcode <= OP_GE;
+}
+
+/* Whether a jump lands inside the len instructions from pc */
+static bool targets_inside(const bool *target, size_t pc, size_t len)
+{
+	for (size_t i = 1; i < len; i++) {
+		if (target[pc + i])
+			return true;
+	}
+	
+	return false;
+}
+
+/* Fuse the predicate at pc into out, returns the instructions fused or 0 */
+static size_t fuse_predicate(const struct filter_bytecode *bc, size_t pc,
+                             const bool *target, struct filter_instruction *out)
+{
+	const struct filter_instruction *in = &bc->instructions[pc];
+	size_t left = bc->instruction_count - pc;
+	
+	if (in[0].opcode != OP_PUSH_FIELD)
+		return 0;
+	
+	memset(out, 0, sizeof(*out));
+	out->operand.fused.field_type = in[0].operand.field.field_type;
+	
+	/* field >= lower AND field <= upper, as compiled by compile_logical_and() */
+	if (left >= 8 &&
+	    in[1].opcode == OP_PUSH_NUMBER && in[2].opcode == OP_GE &&
+	    in[3].opcode == OP_JUMP_IF_FALSE && jump_target(bc, pc + 3) == pc + 8 &&
+	    in[4].opcode == OP_POP &&
+	    in[5].opcode == OP_PUSH_FIELD &&
+	    in[5].operand.field.field_type == in[0].operand.field.field_type &&
+	    in[6].opcode == OP_PUSH_NUMBER && in[7].opcode == OP_LE &&
+	    !targets_inside(target, pc, 8)) {
+		out->opcode = OP_FIELD_IN_RANGE;
+		out->operand.fused.value = in[1].operand.number.value;
+		out->operand.fused.upper = in[6].operand.number.value;
+		return 8;
+	}
+	
+	/* field <cmp> constant */
+	if (left >= 3 && !targets_inside(target, pc, 3)) {
+		if (in[1].opcode == OP_PUSH_NUMBER && is_compare(in[2].opcode)) {
+			out->opcode = OP_FIELD_CMP_NUMBER;
+			out->operand.fused.cmp = in[2].opcode;
+			out->operand.fused.value = in[1].operand.number.value;
+			return 3;
+		}
+		
+		if (in[1].opcode == OP_PUSH_STRING &&
+		    (is_compare(in[2].opcode) || in[2].opcode == OP_MATCH ||
+		     in[2].opcode == OP_NMATCH)) {
+			out->opcode = OP_FIELD_CMP_STRING;
+			out->operand.fused.cmp = in[2].opcode;
+			out->operand.fused.index = in[1].operand.string.string_index;
+			return 3;
+		}
+	}
+	
+	/* field IN [strings] */
+	if (left >= 2 && in[1].opcode == OP_IN_SET && !targets_inside(target, pc, 2)) {
+		out->opcode = OP_FIELD_IN_SET;
+		out->operand.fused.index = in[1].operand.set.set_index;
+		return 2;
+	}
+	
+	return 0;
+}
+
+static size_t optimize_superinstructions(struct filter_bytecode *bc)
+{
+	size_t count = bc->instruction_count;
+	size_t optimizations = 0;
+	size_t n = 0, fused;
+	bool *target = calloc(count + 1, sizeof(*target));
+	size_t *map = malloc((count + 1) * sizeof(*map));
+	size_t *origin = malloc(count * sizeof(*origin));
+	struct filter_instruction *out = malloc(count * sizeof(*out));
+	
+	if (!target || !map || !origin || !out)
+		goto out;
+	
+	/* Sequences with a jump into their middle cannot be fused */
+	for (size_t pc = 0; pc < count; pc++) {
+		if (!is_jump(bc->instructions[pc].opcode))
+			continue;
+		
+		size_t t = jump_target(bc, pc);
+		if (t > count)
+			goto out;
+		target[t] = true;
+	}
+	
+	for (size_t pc = 0; pc < count; pc += fused) {
+		fused = fuse_predicate(bc, pc, target, &out[n]);
+		if (fused) {
+			optimizations++;
+		} else {
+			out[n] = bc->instructions[pc];
+			fused = 1;
+		}
+		
+		for (size_t i = 0; i < fused; i++)
+			map[pc + i] = n;
+		origin[n++] = pc;
+	}
+	map[count] = n;
+	
+	if (optimizations == 0)
+		goto out;
+	
+	/* Retarget jumps to the compacted positions */
+	for (size_t i = 0; i < n; i++) {
+		if (!is_jump(out[i].opcode))
+			continue;
+		
+		int64_t t = (int64_t)map[jump_target(bc, origin[i])];
+		out[i].operand.jump.offset = (int32_t)(t - (int64_t)i -
+		                                       (out[i].opcode == OP_JUMP ? 0 : 1));
+	}
+	
+	memcpy(bc->instructions, out, n * sizeof(*out));
+	bc->instruction_count = n;
+	
+out:
+	free(out);
+	free(origin);
+	free(map);
+	free(target);
+	return optimizations;
+}
+
 /* Public API */
 struct filter_bytecode *filter_compile(struct filter_expr *expr)
 {
@@ -329,16 +660,32 @@ bool filter_compile_node(struct filter_node *node, struct filter_bytecode *bytec
 	return compile_node_recursive(node, bytecode);
 }
 
+struct filter_bytecode *filter_bytecode_ref(struct filter_bytecode *bytecode)
+{
+	if (bytecode)
+		atomic_fetch_add_explicit(&bytecode->refs, 1, memory_order_relaxed);
+	return bytecode;
+}
+
 void filter_bytecode_free(struct filter_bytecode *bytecode)
 {
 	if (!bytecode)
 		return;
+	if (atomic_fetch_sub_explicit(&bytecode->refs, 1, memory_order_acq_rel) != 1)
+		return;
 	
+	filter_jit_release(bytecode);
 	free(bytecode->instructions);
 	
 	for (size_t i = 0; i < bytecode->string_count; i++)
 		free(bytecode->strings[i]);
 	free(bytecode->strings);
+	free(bytecode->string_lens);
+	free(bytecode->string_atoms);
+	
+	for (size_t i = 0; i < bytecode->set_count; i++)
+		filter_atom_set_free(&bytecode->sets[i]);
+	free(bytecode->sets);
 	
 	free(bytecode);
 }
@@ -350,7 +697,12 @@ size_t filter_bytecode_optimize(struct filter_bytecode *bytecode)
 	if (!bytecode)
 		return 0;
 	
+	/* Native code would no longer match the instructions */
+	filter_jit_release(bytecode);
+	bytecode->jit_attempted = false;
+	
 	/* Apply optimization passes */
+	total_optimizations += optimize_superinstructions(bytecode);
 	total_optimizations += optimize_peephole(bytecode);
 	total_optimizations += optimize_dead_code(bytecode);
 	total_optimizations += optimize_constant_folding(bytecode);
@@ -360,6 +712,21 @@ size_t filter_bytecode_optimize(struct filter_bytecode *bytecode)
 	return total_optimizations;
 }
 
+static const char *opcode_symbol(uint8_t opcode)
+{
+	switch (opcode) {
+	case OP_EQ: return "==";
+	case OP_NE: return "!=";
+	case OP_LT: return "<";
+	case OP_GT: return ">";
+	case OP_LE: return "<=";
+	case OP_GE: return ">=";
+	case OP_MATCH: return "=~";
+	case OP_NMATCH: return "!~";
+	default: return "?";
+	}
+}
+
 size_t filter_bytecode_disassemble(struct filter_bytecode *bytecode,
                                    char *buf, size_t size)
 {
@@ -422,6 +789,38 @@ size_t filter_bytecode_disassemble(struct filter_bytecode *bytecode,
 			offset += snprintf(buf + offset, size - offset,
 			                   "IN %u\n", instr->operand.in.count);
 			break;
+		case OP_IN_SET:
+			offset += snprintf(buf + offset, size - offset,
+			                   "IN_SET %u (%u atoms)\n", instr->operand.set.set_index,
+			                   bytecode->sets[instr->operand.set.set_index].count);
+			break;
+		case OP_FIELD_CMP_NUMBER:
+			offset += snprintf(buf + offset, size - offset,
+			                   "FIELD_CMP_NUMBER %u %s %ld\n",
+			                   instr->operand.fused.field_type,
+			                   opcode_symbol(instr->operand.fused.cmp),
+			                   instr->operand.fused.value);
+			break;
+		case OP_FIELD_CMP_STRING:
+			offset += snprintf(buf + offset, size - offset,
+			                   "FIELD_CMP_STRING %u %s \"%s\"\n",
+			                   instr->operand.fused.field_type,
+			                   opcode_symbol(instr->operand.fused.cmp),
+			                   bytecode->strings[instr->operand.fused.index]);
+			break;
+		case OP_FIELD_IN_RANGE:
+			offset += snprintf(buf + offset, size - offset,
+			                   "FIELD_IN_RANGE %u [%ld, %ld]\n",
+			                   instr->operand.fused.field_type,
+			                   instr->operand.fused.value,
+			                   instr->operand.fused.upper);
+			break;
+		case OP_FIELD_IN_SET:
+			offset += snprintf(buf + offset, size - offset,
+			                   "FIELD_IN_SET %u %u\n",
+			                   instr->operand.fused.field_type,
+			                   instr->operand.fused.index);
+			break;
 		case OP_AND:
 			offset += snprintf(buf + offset, size - offset, "AND\n");
 			break;
@@ -443,6 +842,19 @@ size_t filter_bytecode_disassemble(struct filter_bytecode *bytecode,
 			offset += snprintf(buf + offset, size - offset,
 			                   "JUMP_IF_TRUE %d\n", instr->operand.jump.offset);
 			break;
+		case OP_CALL:
+			if (instr->operand.call.arg == FILTER_PREDICATE_ARG_STRING)
+				offset += snprintf(buf + offset, size - offset, "CALL %s \"%s\"\n",
+				                   filter_predicate_name(instr->operand.call.predicate),
+				                   bytecode->strings[instr->operand.call.string_index]);
+			else if (instr->operand.call.arg == FILTER_PREDICATE_ARG_NUMBER)
+				offset += snprintf(buf + offset, size - offset, "CALL %s %ld\n",
+				                   filter_predicate_name(instr->operand.call.predicate),
+				                   instr->operand.call.number);
+			else
+				offset += snprintf(buf + offset, size - offset, "CALL %s\n",
+				                   filter_predicate_name(instr->operand.call.predicate));
+			break;
 		case OP_RETURN:
 			offset += snprintf(buf + offset, size - offset, "RETURN\n");
 			break;
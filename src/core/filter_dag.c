@@ -0,0 +1,771 @@
+/* filter_dag.c - Shared evaluation of many filters
+ *
+ * Leaves are comparisons, compiled to their own optimized bytecode and
+ * identified by a canonical text form of their AST. Inner nodes are
+ * AND, OR and NOT over node indexes. Both are hash consed by linear
+ * search, which is quadratic in the DAG size but only runs when the
+ * filter set changes. Operands keep their order, so short circuiting
+ * and errors behave exactly as in the interpreter.
+ *
+ * Leaves testing a field against a regex without operators also join
+ * one Aho-Corasick automaton per field. The first of them reached for
+ * an event scans the field once and answers all the others.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include "filter_dag.h"
+#include "filter_parser.h"
+#include "filter_compiler.h"
+#include "filter_eval.h"
+#include "filter_atom.h"
+#include "filter_ac.h"
+
+enum dag_kind {
+	DAG_LEAF,
+	DAG_AND,
+	DAG_OR,
+	DAG_NOT,
+};
+
+struct dag_node {
+	enum dag_kind kind;
+	uint32_t left;                  /* Operand of NOT */
+	uint32_t right;
+	struct filter_bytecode *bytecode; /* Predicate of a leaf */
+	char *key;                      /* Canonical form of a leaf */
+	
+	/* Literal leaf, pattern of a scan, or scan SIZE_MAX if none */
+	size_t scan;
+	uint32_t pattern;
+	bool negate;
+};
+
+/* Automaton over all literal patterns tested on one field */
+struct dag_scan {
+	uint8_t field;
+	struct filter_ac *ac;
+	bool built;                     /* Leaves fall back to bytecode if not */
+	uint32_t *hits;                 /* Pattern found where hits == epoch */
+	size_t pattern_count;
+	uint32_t stamp;                 /* Epoch of the last scan */
+	int8_t result;                  /* -1 error, 0 not a string, 1 scanned */
+};
+
+/* Index entry of a filter requiring field == value */
+struct dag_key {
+	uint8_t field;
+	bool is_string;
+	int64_t value;                  /* Number, or atom of a string */
+	uint32_t filter;
+};
+
+struct filter_dag {
+	struct dag_node *nodes;
+	size_t node_count;
+	size_t node_capacity;
+	size_t predicate_count;
+	
+	/* Result of a node for the current event, valid where stamps == epoch */
+	uint32_t *stamps;
+	int8_t *values;
+	uint32_t epoch;
+	
+	uint32_t *roots;                /* Root node of each filter */
+	size_t filter_count;
+	size_t filter_capacity;
+	
+	struct dag_key *keys;           /* Sorted by field, type and value */
+	size_t key_count;
+	bool keys_sorted;
+	
+	uint32_t *unkeyed;              /* Filters visited for every event */
+	size_t unkeyed_count;
+	
+	uint32_t *matches;              /* Scratch, one entry per filter */
+	
+	struct dag_scan *scans;
+	size_t scan_count;
+	bool scans_built;
+	size_t literal_count;
+	
+	uint64_t evals;
+	uint64_t node_evals;
+};
+
+/* Growable text for canonical leaf forms */
+struct keybuf {
+	char *buf;
+	size_t len;
+	size_t cap;
+	bool failed;
+};
+
+static void keybuf_printf(struct keybuf *kb, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+	
+	if (kb->failed)
+		return;
+	
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(kb->buf + kb->len, kb->cap - kb->len, fmt, ap);
+		va_end(ap);
+		
+		if (n < 0) {
+			kb->failed = true;
+			return;
+		}
+		if ((size_t)n < kb->cap - kb->len) {
+			kb->len += n;
+			return;
+		}
+		
+		size_t cap = (kb->cap - kb->len + n + 1) * 2 + kb->cap;
+		char *buf = realloc(kb->buf, cap);
+		if (!buf) {
+			kb->failed = true;
+			return;
+		}
+		kb->buf = buf;
+		kb->cap = cap;
+	}
+}
+
+/* Serialize a subtree, strings are length prefixed so any content is safe */
+static void canonical_form(struct keybuf *kb, const struct filter_node *node)
+{
+	switch (node->type) {
+	case FILTER_NODE_FIELD:
+		keybuf_printf(kb, "f%d", (int)node->data.field.field);
+		break;
+	case FILTER_NODE_STRING:
+		keybuf_printf(kb, "s%zu:%s", strlen(node->data.string.value),
+		              node->data.string.value);
+		break;
+	case FILTER_NODE_NUMBER:
+		keybuf_printf(kb, "n%" PRId64, node->data.number.value);
+		break;
+	case FILTER_NODE_LIST:
+		keybuf_printf(kb, "[");
+		for (size_t i = 0; i < node->data.list.count; i++)
+			canonical_form(kb, node->data.list.items[i]);
+		keybuf_printf(kb, "]");
+		break;
+	case FILTER_NODE_NOT:
+		keybuf_printf(kb, "(%d ", (int)node->type);
+		canonical_form(kb, node->data.unary.operand);
+		keybuf_printf(kb, ")");
+		break;
+	case FILTER_NODE_CALL:
+		keybuf_printf(kb, "c%d(", node->data.call.predicate);
+		if (node->data.call.arg)
+			canonical_form(kb, node->data.call.arg);
+		keybuf_printf(kb, ")");
+		break;
+	default:
+		keybuf_printf(kb, "(%d ", (int)node->type);
+		canonical_form(kb, node->data.binary.left);
+		keybuf_printf(kb, " ");
+		canonical_form(kb, node->data.binary.right);
+		keybuf_printf(kb, ")");
+		break;
+	}
+}
+
+static bool is_logical(const struct filter_node *node)
+{
+	return node->type == FILTER_NODE_AND || node->type == FILTER_NODE_OR ||
+	       node->type == FILTER_NODE_NOT;
+}
+
+static bool is_comparison(const struct filter_node *node)
+{
+	return node->type >= FILTER_NODE_EQ && node->type <= FILTER_NODE_IN;
+}
+
+/* Whether only comparisons appear below the logical operators */
+static bool splittable(const struct filter_node *node)
+{
+	if (is_comparison(node))
+		return true;
+	if (node->type == FILTER_NODE_NOT)
+		return splittable(node->data.unary.operand);
+	if (node->type == FILTER_NODE_AND || node->type == FILTER_NODE_OR)
+		return splittable(node->data.binary.left) &&
+		       splittable(node->data.binary.right);
+	return false;
+}
+
+static bool dag_reserve_node(struct filter_dag *dag)
+{
+	size_t cap;
+	void *p;
+	
+	if (dag->node_count < dag->node_capacity)
+		return true;
+	
+	cap = dag->node_capacity ? dag->node_capacity * 2 : 64;
+	
+	p = realloc(dag->nodes, cap * sizeof(*dag->nodes));
+	if (!p)
+		return false;
+	dag->nodes = p;
+	
+	p = realloc(dag->stamps, cap * sizeof(*dag->stamps));
+	if (!p)
+		return false;
+	dag->stamps = p;
+	
+	p = realloc(dag->values, cap * sizeof(*dag->values));
+	if (!p)
+		return false;
+	dag->values = p;
+	
+	memset(dag->stamps + dag->node_capacity, 0,
+	       (cap - dag->node_capacity) * sizeof(*dag->stamps));
+	dag->node_capacity = cap;
+	return true;
+}
+
+static int dag_intern_inner(struct filter_dag *dag, enum dag_kind kind,
+                            uint32_t left, uint32_t right)
+{
+	struct dag_node *node;
+	
+	for (size_t i = 0; i < dag->node_count; i++) {
+		node = &dag->nodes[i];
+		if (node->kind == kind && node->left == left && node->right == right)
+			return (int)i;
+	}
+	
+	if (!dag_reserve_node(dag))
+		return -1;
+	
+	node = &dag->nodes[dag->node_count];
+	memset(node, 0, sizeof(*node));
+	node->kind = kind;
+	node->left = left;
+	node->right = right;
+	return (int)dag->node_count++;
+}
+
+/* Scan of a field, created on first use */
+static struct dag_scan *dag_get_scan(struct filter_dag *dag, uint8_t field)
+{
+	struct dag_scan *scan;
+	
+	for (size_t i = 0; i < dag->scan_count; i++) {
+		if (dag->scans[i].field == field)
+			return &dag->scans[i];
+	}
+	
+	scan = realloc(dag->scans, (dag->scan_count + 1) * sizeof(*scan));
+	if (!scan)
+		return NULL;
+	dag->scans = scan;
+	
+	scan = &dag->scans[dag->scan_count];
+	memset(scan, 0, sizeof(*scan));
+	scan->field = field;
+	scan->ac = filter_ac_create();
+	if (!scan->ac)
+		return NULL;
+	
+	dag->scan_count++;
+	return scan;
+}
+
+/* Route field =~ "literal" and field !~ "literal" through a scan */
+static void dag_add_literal(struct filter_dag *dag, struct dag_node *node,
+                            const struct filter_node *ast)
+{
+	const struct filter_node *left = ast->data.binary.left;
+	const struct filter_node *right = ast->data.binary.right;
+	struct dag_scan *scan;
+	size_t len, literal_len;
+	char *literal;
+	uint32_t *hits;
+	int pattern;
+	
+	node->scan = SIZE_MAX;
+	
+	if ((ast->type != FILTER_NODE_MATCH && ast->type != FILTER_NODE_NMATCH) ||
+	    left->type != FILTER_NODE_FIELD || right->type != FILTER_NODE_STRING)
+		return;
+	
+	len = strlen(right->data.string.value);
+	literal = malloc(len + 1);
+	if (!literal)
+		return;
+	
+	if (!filter_ac_literal(right->data.string.value, len, literal, &literal_len)) {
+		free(literal);
+		return;
+	}
+	
+	scan = dag_get_scan(dag, left->data.field.field);
+	pattern = scan ? filter_ac_add(scan->ac, literal, literal_len) : -1;
+	free(literal);
+	if (pattern < 0)
+		return;
+	
+	if ((size_t)pattern >= scan->pattern_count) {
+		hits = realloc(scan->hits, (pattern + 1) * sizeof(*hits));
+		if (!hits)
+			return;
+		memset(hits + scan->pattern_count, 0,
+		       (pattern + 1 - scan->pattern_count) * sizeof(*hits));
+		scan->hits = hits;
+		scan->pattern_count = pattern + 1;
+	}
+	
+	node->scan = scan - dag->scans;
+	node->pattern = pattern;
+	node->negate = ast->type == FILTER_NODE_NMATCH;
+	dag->scans_built = false;
+	dag->literal_count++;
+}
+
+static int dag_intern_leaf(struct filter_dag *dag, const struct filter_node *ast)
+{
+	struct keybuf kb = {0};
+	struct filter_expr expr;
+	struct filter_bytecode *bytecode;
+	struct dag_node *node;
+	
+	canonical_form(&kb, ast);
+	if (kb.failed || !kb.buf) {
+		free(kb.buf);
+		return -1;
+	}
+	
+	for (size_t i = 0; i < dag->node_count; i++) {
+		node = &dag->nodes[i];
+		if (node->kind == DAG_LEAF && strcmp(node->key, kb.buf) == 0) {
+			free(kb.buf);
+			return (int)i;
+		}
+	}
+	
+	/* The compiler only reads the AST */
+	memset(&expr, 0, sizeof(expr));
+	expr.ast = (struct filter_node *)ast;
+	expr.valid = true;
+	
+	bytecode = filter_compile(&expr);
+	if (!bytecode || !dag_reserve_node(dag)) {
+		filter_bytecode_free(bytecode);
+		free(kb.buf);
+		return -1;
+	}
+	filter_bytecode_optimize(bytecode);
+	
+	node = &dag->nodes[dag->node_count];
+	memset(node, 0, sizeof(*node));
+	node->kind = DAG_LEAF;
+	node->bytecode = bytecode;
+	node->key = kb.buf;
+	dag_add_literal(dag, node, ast);
+	dag->predicate_count++;
+	return (int)dag->node_count++;
+}
+
+static int dag_build(struct filter_dag *dag, const struct filter_node *ast)
+{
+	int left, right;
+	
+	switch (ast->type) {
+	case FILTER_NODE_AND:
+	case FILTER_NODE_OR:
+		left = dag_build(dag, ast->data.binary.left);
+		if (left < 0)
+			return -1;
+		right = dag_build(dag, ast->data.binary.right);
+		if (right < 0)
+			return -1;
+		return dag_intern_inner(dag, ast->type == FILTER_NODE_AND ? DAG_AND : DAG_OR,
+		                        left, right);
+		
+	case FILTER_NODE_NOT:
+		left = dag_build(dag, ast->data.unary.operand);
+		if (left < 0)
+			return -1;
+		return dag_intern_inner(dag, DAG_NOT, left, 0);
+		
+	default:
+		return dag_intern_leaf(dag, ast);
+	}
+}
+
+/* First field == constant of the top level conjunction, which must hold */
+static const struct filter_node *find_key(const struct filter_node *ast)
+{
+	const struct filter_node *key;
+	
+	if (ast->type == FILTER_NODE_AND) {
+		key = find_key(ast->data.binary.left);
+		return key ? key : find_key(ast->data.binary.right);
+	}
+	
+	if (ast->type == FILTER_NODE_EQ &&
+	    ast->data.binary.left->type == FILTER_NODE_FIELD &&
+	    (ast->data.binary.right->type == FILTER_NODE_STRING ||
+	     ast->data.binary.right->type == FILTER_NODE_NUMBER))
+		return ast;
+	
+	return NULL;
+}
+
+static int key_cmp(const struct dag_key *a, const struct dag_key *b)
+{
+	if (a->field != b->field)
+		return a->field < b->field ? -1 : 1;
+	if (a->is_string != b->is_string)
+		return a->is_string ? 1 : -1;
+	if (a->value != b->value)
+		return a->value < b->value ? -1 : 1;
+	return 0;
+}
+
+static int key_sort_cmp(const void *a, const void *b)
+{
+	int cmp = key_cmp(a, b);
+	
+	if (cmp != 0)
+		return cmp;
+	return ((const struct dag_key *)a)->filter < ((const struct dag_key *)b)->filter ? -1 : 1;
+}
+
+static int id_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	
+	return (x > y) - (x < y);
+}
+
+struct filter_dag *filter_dag_create(void)
+{
+	struct filter_dag *dag = calloc(1, sizeof(*dag));
+	if (!dag)
+		return NULL;
+	
+	dag->epoch = 1;
+	dag->keys_sorted = true;
+	dag->scans_built = true;
+	return dag;
+}
+
+void filter_dag_destroy(struct filter_dag *dag)
+{
+	if (!dag)
+		return;
+	
+	for (size_t i = 0; i < dag->node_count; i++) {
+		filter_bytecode_free(dag->nodes[i].bytecode);
+		free(dag->nodes[i].key);
+	}
+	
+	free(dag->nodes);
+	free(dag->stamps);
+	free(dag->values);
+	free(dag->roots);
+	free(dag->keys);
+	free(dag->unkeyed);
+	free(dag->matches);
+	
+	for (size_t i = 0; i < dag->scan_count; i++) {
+		filter_ac_destroy(dag->scans[i].ac);
+		free(dag->scans[i].hits);
+	}
+	free(dag->scans);
+	free(dag);
+}
+
+int filter_dag_add(struct filter_dag *dag, const struct filter_node *ast)
+{
+	const struct filter_node *key;
+	uint32_t id;
+	int root;
+	void *p;
+	
+	if (!dag || !ast)
+		return -1;
+	
+	if (dag->filter_count == dag->filter_capacity) {
+		size_t cap = dag->filter_capacity ? dag->filter_capacity * 2 : 16;
+		
+		p = realloc(dag->roots, cap * sizeof(*dag->roots));
+		if (!p)
+			return -1;
+		dag->roots = p;
+		
+		p = realloc(dag->keys, cap * sizeof(*dag->keys));
+		if (!p)
+			return -1;
+		dag->keys = p;
+		
+		p = realloc(dag->unkeyed, cap * sizeof(*dag->unkeyed));
+		if (!p)
+			return -1;
+		dag->unkeyed = p;
+		
+		p = realloc(dag->matches, cap * sizeof(*dag->matches));
+		if (!p)
+			return -1;
+		dag->matches = p;
+		
+		dag->filter_capacity = cap;
+	}
+	
+	/* Anything but comparisons below AND, OR and NOT stays one predicate */
+	root = is_logical(ast) && splittable(ast) ? dag_build(dag, ast) :
+	                                              dag_intern_leaf(dag, ast);
+	if (root < 0)
+		return -1;
+	
+	id = dag->filter_count++;
+	dag->roots[id] = root;
+	
+	key = find_key(ast);
+	if (key) {
+		struct dag_key *k = &dag->keys[dag->key_count];
+		const struct filter_node *constant = key->data.binary.right;
+		
+		k->field = key->data.binary.left->data.field.field;
+		k->filter = id;
+		k->is_string = constant->type == FILTER_NODE_STRING;
+		if (k->is_string) {
+			const char *str = constant->data.string.value;
+			
+			k->value = filter_atom_intern(str, strlen(str));
+			if (k->value == FILTER_ATOM_NONE)
+				key = NULL;
+		} else {
+			k->value = constant->data.number.value;
+		}
+	}
+	
+	if (key) {
+		dag->key_count++;
+		dag->keys_sorted = false;
+	} else {
+		dag->unkeyed[dag->unkeyed_count++] = id;
+	}
+	
+	return (int)id;
+}
+
+struct scan_hits {
+	uint32_t *hits;
+	uint32_t epoch;
+};
+
+static void record_hit(uint32_t id, void *arg)
+{
+	struct scan_hits *scan_hits = arg;
+	
+	scan_hits->hits[id] = scan_hits->epoch;
+}
+
+/* Match a literal leaf, scanning its field on first use for the event */
+static int dag_eval_literal(struct filter_dag *dag, struct dag_node *node,
+                            struct nlmon_event *event, struct filter_eval_context *ctx)
+{
+	struct dag_scan *scan = &dag->scans[node->scan];
+	struct filter_value value;
+	bool hit;
+	
+	if (!scan->built)
+		return filter_eval_predicate(node->bytecode, event, ctx);
+	
+	if (scan->stamp != dag->epoch) {
+		struct scan_hits scan_hits = { scan->hits, dag->epoch };
+		
+		scan->stamp = dag->epoch;
+		if (!filter_eval_field(ctx, event, scan->field, &value)) {
+			scan->result = -1;
+		} else if (value.type != FILTER_VALUE_STRING) {
+			scan->result = 0;
+		} else {
+			filter_ac_scan(scan->ac, value.data.string_val.ptr,
+			               value.data.string_val.len, record_hit, &scan_hits);
+			scan->result = 1;
+		}
+	}
+	
+	/* Like the interpreter, a non-string matches neither =~ nor !~ */
+	if (scan->result <= 0)
+		return scan->result;
+	
+	hit = scan->hits[node->pattern] == dag->epoch;
+	return node->negate ? !hit : hit;
+}
+
+static int dag_eval_node(struct filter_dag *dag, uint32_t index,
+                         struct nlmon_event *event, struct filter_eval_context *ctx)
+{
+	struct dag_node *node = &dag->nodes[index];
+	int ret;
+	
+	if (dag->stamps[index] == dag->epoch)
+		return dag->values[index];
+	
+	dag->node_evals++;
+	
+	switch (node->kind) {
+	case DAG_LEAF:
+		if (node->scan != SIZE_MAX)
+			ret = dag_eval_literal(dag, node, event, ctx);
+		else
+			ret = filter_eval_predicate(node->bytecode, event, ctx);
+		break;
+	case DAG_AND:
+		ret = dag_eval_node(dag, node->left, event, ctx);
+		if (ret == 1)
+			ret = dag_eval_node(dag, node->right, event, ctx);
+		break;
+	case DAG_OR:
+		ret = dag_eval_node(dag, node->left, event, ctx);
+		if (ret == 0)
+			ret = dag_eval_node(dag, node->right, event, ctx);
+		break;
+	case DAG_NOT:
+	default:
+		ret = dag_eval_node(dag, node->left, event, ctx);
+		if (ret >= 0)
+			ret = !ret;
+		break;
+	}
+	
+	dag->stamps[index] = dag->epoch;
+	dag->values[index] = (int8_t)ret;
+	return ret;
+}
+
+/* Key describing the value of a field in an event, false if none can match */
+static bool event_key(struct nlmon_event *event, struct filter_eval_context *ctx,
+                      struct dag_key *probe)
+{
+	struct filter_value value;
+	uint32_t atom;
+	
+	if (!filter_eval_field(ctx, event, probe->field, &value))
+		return false;
+	
+	switch (value.type) {
+	case FILTER_VALUE_NUMBER:
+		probe->is_string = false;
+		probe->value = value.data.number_val;
+		return true;
+	case FILTER_VALUE_STRING:
+		atom = value.data.string_val.atom;
+		if (atom == FILTER_ATOM_NONE)
+			atom = filter_atom_lookup(value.data.string_val.ptr,
+			                          value.data.string_val.len);
+		if (atom == FILTER_ATOM_ABSENT)
+			return false;
+		probe->is_string = true;
+		probe->value = atom;
+		return true;
+	default:
+		return false;
+	}
+}
+
+size_t filter_dag_eval(struct filter_dag *dag, struct nlmon_event *event,
+                       struct filter_eval_context *ctx,
+                       uint32_t *ids, size_t max_ids)
+{
+	size_t count = 0;
+	size_t start, end, lo, hi;
+	struct dag_key probe;
+	uint32_t id;
+	
+	if (!dag || !event || !ctx)
+		return 0;
+	
+	if (!dag->keys_sorted) {
+		qsort(dag->keys, dag->key_count, sizeof(*dag->keys), key_sort_cmp);
+		dag->keys_sorted = true;
+	}
+	
+	if (!dag->scans_built) {
+		for (size_t i = 0; i < dag->scan_count; i++)
+			dag->scans[i].built = filter_ac_build(dag->scans[i].ac);
+		dag->scans_built = true;
+	}
+	
+	/* New event, forget all node results and scans */
+	if (++dag->epoch == 0) {
+		memset(dag->stamps, 0, dag->node_capacity * sizeof(*dag->stamps));
+		for (size_t i = 0; i < dag->scan_count; i++) {
+			dag->scans[i].stamp = 0;
+			memset(dag->scans[i].hits, 0,
+			       dag->scans[i].pattern_count * sizeof(*dag->scans[i].hits));
+		}
+		dag->epoch = 1;
+	}
+	dag->evals++;
+	
+	/* One field lookup and binary search per keyed field */
+	for (start = 0; start < dag->key_count; start = end) {
+		for (end = start + 1; end < dag->key_count; end++) {
+			if (dag->keys[end].field != dag->keys[start].field)
+				break;
+		}
+		
+		probe.field = dag->keys[start].field;
+		if (!event_key(event, ctx, &probe))
+			continue;
+		
+		lo = start;
+		hi = end;
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+			
+			if (key_cmp(&dag->keys[mid], &probe) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		
+		for (; lo < end && key_cmp(&dag->keys[lo], &probe) == 0; lo++) {
+			id = dag->keys[lo].filter;
+			if (dag_eval_node(dag, dag->roots[id], event, ctx) == 1)
+				dag->matches[count++] = id;
+		}
+	}
+	
+	for (size_t i = 0; i < dag->unkeyed_count; i++) {
+		id = dag->unkeyed[i];
+		if (dag_eval_node(dag, dag->roots[id], event, ctx) == 1)
+			dag->matches[count++] = id;
+	}
+	
+	qsort(dag->matches, count, sizeof(*dag->matches), id_cmp);
+	
+	if (ids)
+		memcpy(ids, dag->matches, (count < max_ids ? count : max_ids) * sizeof(*ids));
+	
+	return count;
+}
+
+void filter_dag_get_stats(struct filter_dag *dag, struct filter_dag_stats *stats)
+{
+	if (!dag || !stats)
+		return;
+	
+	stats->filters = dag->filter_count;
+	stats->keyed = dag->key_count;
+	stats->predicates = dag->predicate_count;
+	stats->literals = dag->literal_count;
+	stats->nodes = dag->node_count;
+	stats->evals = dag->evals;
+	stats->node_evals = dag->node_evals;
+}
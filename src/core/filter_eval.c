@@ -7,18 +7,27 @@
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
+#include <pthread.h>
 #include <linux/netlink.h>
 #include "filter_eval.h"
+#include "filter_atom.h"
+#include "filter_regex.h"
+#include "filter_jit.h"
 #include "filter_compiler.h"
 #include "filter_parser.h"
+#include "filter_predicate.h"
 #include "event_processor.h"
+#include "nlmon_probes.h"
 #include "nlmon_nl_route.h"
 #include "nlmon_nl_genl.h"
 #include "nlmon_nl_diag.h"
 #include "nlmon_nl_netfilter.h"
 
 #define INITIAL_STACK_CAPACITY 32
-#define INITIAL_REGEX_CACHE_CAPACITY 8
+
+/* Size of the per opcode statistics arrays */
+#define MAX_OPCODES 32
+_Static_assert(OP_FIELD_IN_SET < MAX_OPCODES, "opcode statistics too small");
 
 /* Helper functions for stack operations */
 static bool stack_push(struct filter_eval_context *ctx, struct filter_value value)
@@ -55,62 +64,195 @@ static bool stack_peek(struct filter_eval_context *ctx, struct filter_value *val
 	return true;
 }
 
-static void value_free(struct filter_value *value)
+/* Borrow a string of at most size bytes, fixed size event fields may fill it */
+static bool value_set_string(struct filter_value *value, const char *str, size_t size)
 {
-	if (value->type == FILTER_VALUE_STRING && value->data.string_val) {
-		free(value->data.string_val);
-		value->data.string_val = NULL;
-	}
+	value->type = FILTER_VALUE_STRING;
+	value->data.string_val.ptr = str;
+	value->data.string_val.len = strnlen(str, size);
+	value->data.string_val.atom = FILTER_ATOM_NONE;
+	return true;
 }
 
+#define value_set_field(value, field) value_set_string(value, field, sizeof(field))
+
 /* Regex cache functions */
-static regex_t *get_compiled_regex(struct filter_eval_context *ctx, const char *pattern)
+#define REGEX_NONE UINT32_MAX
+
+struct regex_cache_entry {
+	struct filter_regex *regex;     /* Reference into the store */
+	uint32_t chain;                 /* Next entry + 1 in the bucket */
+	uint32_t prev;                  /* LRU neighbours, REGEX_NONE at the ends */
+	uint32_t next;
+};
+
+static void regex_lru_unlink(struct filter_eval_context *ctx, uint32_t idx)
 {
-	/* Check cache */
-	for (size_t i = 0; i < ctx->regex_cache_size; i++) {
-		if (ctx->regex_cache[i].valid &&
-		    strcmp(ctx->regex_cache[i].pattern, pattern) == 0) {
-			return &ctx->regex_cache[i].compiled;
-		}
+	struct regex_cache_entry *entry = &ctx->regex_cache[idx];
+	
+	if (entry->prev != REGEX_NONE)
+		ctx->regex_cache[entry->prev].next = entry->next;
+	else
+		ctx->regex_lru_head = entry->next;
+	
+	if (entry->next != REGEX_NONE)
+		ctx->regex_cache[entry->next].prev = entry->prev;
+	else
+		ctx->regex_lru_tail = entry->prev;
+}
+
+static void regex_lru_push(struct filter_eval_context *ctx, uint32_t idx)
+{
+	struct regex_cache_entry *entry = &ctx->regex_cache[idx];
+	
+	entry->prev = REGEX_NONE;
+	entry->next = ctx->regex_lru_head;
+	if (ctx->regex_lru_head != REGEX_NONE)
+		ctx->regex_cache[ctx->regex_lru_head].prev = idx;
+	else
+		ctx->regex_lru_tail = idx;
+	ctx->regex_lru_head = idx;
+}
+
+/* Drop the least recently used entry, returns its slot */
+static uint32_t regex_cache_evict(struct filter_eval_context *ctx)
+{
+	uint32_t idx = ctx->regex_lru_tail;
+	struct regex_cache_entry *entry = &ctx->regex_cache[idx];
+	uint32_t *link = &ctx->regex_buckets[entry->regex->hash & ctx->regex_bucket_mask];
+	
+	while (*link != idx + 1)
+		link = &ctx->regex_cache[*link - 1].chain;
+	*link = entry->chain;
+	
+	regex_lru_unlink(ctx, idx);
+	filter_regex_put(entry->regex);
+	ctx->regex_stats.evictions++;
+	return idx;
+}
+
+static void regex_cache_flush(struct filter_eval_context *ctx)
+{
+	for (size_t i = 0; i < ctx->regex_cache_size; i++)
+		filter_regex_put(ctx->regex_cache[i].regex);
+	
+	ctx->regex_cache_size = 0;
+	ctx->regex_lru_head = REGEX_NONE;
+	ctx->regex_lru_tail = REGEX_NONE;
+	if (ctx->regex_buckets)
+		memset(ctx->regex_buckets, 0,
+		       (ctx->regex_bucket_mask + 1) * sizeof(*ctx->regex_buckets));
+}
+
+/* Allocate an empty cache, the old one must have been flushed */
+static bool regex_cache_alloc(struct filter_eval_context *ctx, size_t capacity)
+{
+	struct regex_cache_entry *cache;
+	uint32_t *buckets;
+	size_t size = 4;
+	
+	while (size < capacity)
+		size *= 2;
+	
+	cache = malloc(capacity * sizeof(*cache));
+	buckets = calloc(size, sizeof(*buckets));
+	if (!cache || !buckets) {
+		free(cache);
+		free(buckets);
+		return false;
 	}
 	
-	/* Not in cache, compile and add */
-	if (ctx->regex_cache_size >= ctx->regex_cache_capacity) {
-		size_t new_capacity = ctx->regex_cache_capacity * 2;
-		void *new_cache = realloc(ctx->regex_cache,
-		                          new_capacity * sizeof(*ctx->regex_cache));
-		if (!new_cache)
-			return NULL;
-		ctx->regex_cache = new_cache;
-		ctx->regex_cache_capacity = new_capacity;
+	free(ctx->regex_cache);
+	free(ctx->regex_buckets);
+	ctx->regex_cache = cache;
+	ctx->regex_buckets = buckets;
+	ctx->regex_bucket_mask = size - 1;
+	ctx->regex_cache_capacity = capacity;
+	ctx->regex_cache_size = 0;
+	ctx->regex_lru_head = REGEX_NONE;
+	ctx->regex_lru_tail = REGEX_NONE;
+	return true;
+}
+
+static struct filter_regex *get_compiled_regex(struct filter_eval_context *ctx,
+                                               const char *pattern, size_t len)
+{
+	uint32_t hash = filter_regex_hash(pattern, len);
+	struct regex_cache_entry *entry;
+	struct filter_regex *regex;
+	uint32_t *bucket, idx;
+	bool compiled;
+	
+	/* Check cache */
+	bucket = &ctx->regex_buckets[hash & ctx->regex_bucket_mask];
+	for (idx = *bucket; idx; idx = entry->chain) {
+		entry = &ctx->regex_cache[idx - 1];
+		regex = entry->regex;
+		
+		if (regex->hash == hash && regex->pattern_len == len &&
+		    memcmp(regex->pattern, pattern, len) == 0) {
+			if (ctx->regex_lru_head != idx - 1) {
+				regex_lru_unlink(ctx, idx - 1);
+				regex_lru_push(ctx, idx - 1);
+			}
+			ctx->regex_stats.hits++;
+			return regex;
+		}
 	}
 	
-	size_t idx = ctx->regex_cache_size++;
-	ctx->regex_cache[idx].pattern = strdup(pattern);
-	if (!ctx->regex_cache[idx].pattern)
+	/* Not in cache, take it from the store, compiling only if no one has */
+	ctx->regex_stats.misses++;
+	regex = filter_regex_get(pattern, len, hash, &compiled);
+	if (!regex)
 		return NULL;
+	if (compiled)
+		ctx->regex_stats.compiles++;
 	
-	int ret = regcomp(&ctx->regex_cache[idx].compiled, pattern,
-	                  REG_EXTENDED | REG_NOSUB);
-	if (ret != 0) {
-		free(ctx->regex_cache[idx].pattern);
-		ctx->regex_cache_size--;
-		return NULL;
+	if (ctx->regex_cache_size < ctx->regex_cache_capacity)
+		idx = ctx->regex_cache_size++;
+	else
+		idx = regex_cache_evict(ctx);
+	
+	entry = &ctx->regex_cache[idx];
+	entry->regex = regex;
+	entry->chain = *bucket;
+	*bucket = idx + 1;
+	regex_lru_push(ctx, idx);
+	
+	return regex;
+}
+
+/* Interface atom, looked up once for all filters run on the same name */
+static uint32_t interface_atom(struct filter_eval_context *ctx,
+                               const struct nlmon_event *event)
+{
+	uint32_t generation = filter_atom_generation();
+	
+	if (ctx->interface_atom == FILTER_ATOM_NONE ||
+	    ctx->atom_generation != generation ||
+	    memcmp(ctx->atom_interface, event->interface, sizeof(ctx->atom_interface)) != 0) {
+		memcpy(ctx->atom_interface, event->interface, sizeof(ctx->atom_interface));
+		ctx->atom_generation = generation;
+		ctx->interface_atom = filter_atom_lookup(event->interface,
+		                                         strnlen(event->interface, sizeof(event->interface)));
 	}
 	
-	ctx->regex_cache[idx].valid = true;
-	return &ctx->regex_cache[idx].compiled;
+	return ctx->interface_atom;
 }
 
 /* Field extraction from event */
-static bool extract_field(struct nlmon_event *event, uint8_t field_type,
-                          struct filter_value *value)
+static bool extract_field(struct filter_eval_context *ctx, struct nlmon_event *event,
+                          uint8_t field_type, struct filter_value *value)
 {
+	/* Header fields are set on receive, everything else may be deferred */
+	if (field_type == FILTER_FIELD_INTERFACE || field_type >= FILTER_FIELD_NL_LINK_IFNAME)
+		nlmon_event_materialize(event);
+	
 	switch (field_type) {
 	case FILTER_FIELD_INTERFACE:
-		value->type = FILTER_VALUE_STRING;
-		value->data.string_val = strdup(event->interface);
-		return value->data.string_val != NULL;
+		value_set_field(value, event->interface);
+		value->data.string_val.atom = interface_atom(ctx, event);
+		return true;
 		
 	case FILTER_FIELD_MESSAGE_TYPE:
 		value->type = FILTER_VALUE_NUMBER;
@@ -134,10 +276,8 @@ static bool extract_field(struct nlmon_event *event, uint8_t field_type,
 		
 	case FILTER_FIELD_NAMESPACE:
 		/* Namespace not in basic event structure, return empty string */
-		value->type = FILTER_VALUE_STRING;
-		value->data.string_val = strdup("");
-		return value->data.string_val != NULL;
-	
+		return value_set_string(value, "", 0);
+		
 	/* Netlink common fields */
 	case FILTER_FIELD_NL_PROTOCOL:
 		value->type = FILTER_VALUE_NUMBER;
@@ -180,17 +320,13 @@ static bool extract_field(struct nlmon_event *event, uint8_t field_type,
 		return true;
 		
 	case FILTER_FIELD_NL_GENL_FAMILY_NAME:
-		value->type = FILTER_VALUE_STRING;
-		value->data.string_val = strdup(event->netlink.genl_family_name);
-		return value->data.string_val != NULL;
-	
+		return value_set_field(value, event->netlink.genl_family_name);
+		
 	/* NETLINK_ROUTE link fields */
 	case FILTER_FIELD_NL_LINK_IFNAME:
 		if (!event->netlink.data.link)
 			return false;
-		value->type = FILTER_VALUE_STRING;
-		value->data.string_val = strdup(event->netlink.data.link->ifname);
-		return value->data.string_val != NULL;
+		return value_set_field(value, event->netlink.data.link->ifname);
 		
 	case FILTER_FIELD_NL_LINK_IFINDEX:
 		if (!event->netlink.data.link)
@@ -223,10 +359,8 @@ static bool extract_field(struct nlmon_event *event, uint8_t field_type,
 	case FILTER_FIELD_NL_LINK_QDISC:
 		if (!event->netlink.data.link)
 			return false;
-		value->type = FILTER_VALUE_STRING;
-		value->data.string_val = strdup(event->netlink.data.link->qdisc);
-		return value->data.string_val != NULL;
-	
+		return value_set_field(value, event->netlink.data.link->qdisc);
+		
 	/* NETLINK_ROUTE address fields */
 	case FILTER_FIELD_NL_ADDR_FAMILY:
 		if (!event->netlink.data.addr)
@@ -259,17 +393,13 @@ static bool extract_field(struct nlmon_event *event, uint8_t field_type,
 	case FILTER_FIELD_NL_ADDR_ADDR:
 		if (!event->netlink.data.addr)
 			return false;
-		value->type = FILTER_VALUE_STRING;
-		value->data.string_val = strdup(event->netlink.data.addr->addr);
-		return value->data.string_val != NULL;
+		return value_set_field(value, event->netlink.data.addr->addr);
 		
 	case FILTER_FIELD_NL_ADDR_LABEL:
 		if (!event->netlink.data.addr)
 			return false;
-		value->type = FILTER_VALUE_STRING;
-		value->data.string_val = strdup(event->netlink.data.addr->label);
-		return value->data.string_val != NULL;
-	
+		return value_set_field(value, event->netlink.data.addr->label);
+		
 	/* NETLINK_ROUTE route fields */
 	case FILTER_FIELD_NL_ROUTE_FAMILY:
 		if (!event->netlink.data.route)
@@ -281,23 +411,17 @@ static bool extract_field(struct nlmon_event *event, uint8_t field_type,
 	case FILTER_FIELD_NL_ROUTE_DST:
 		if (!event->netlink.data.route)
 			return false;
-		value->type = FILTER_VALUE_STRING;
-		value->data.string_val = strdup(event->netlink.data.route->dst);
-		return value->data.string_val != NULL;
+		return value_set_field(value, event->netlink.data.route->dst);
 		
 	case FILTER_FIELD_NL_ROUTE_SRC:
 		if (!event->netlink.data.route)
 			return false;
-		value->type = FILTER_VALUE_STRING;
-		value->data.string_val = strdup(event->netlink.data.route->src);
-		return value->data.string_val != NULL;
+		return value_set_field(value, event->netlink.data.route->src);
 		
 	case FILTER_FIELD_NL_ROUTE_GATEWAY:
 		if (!event->netlink.data.route)
 			return false;
-		value->type = FILTER_VALUE_STRING;
-		value->data.string_val = strdup(event->netlink.data.route->gateway);
-		return value->data.string_val != NULL;
+		return value_set_field(value, event->netlink.data.route->gateway);
 		
 	case FILTER_FIELD_NL_ROUTE_OIF:
 		if (!event->netlink.data.route)
@@ -333,7 +457,7 @@ static bool extract_field(struct nlmon_event *event, uint8_t field_type,
 		value->type = FILTER_VALUE_NUMBER;
 		value->data.number_val = event->netlink.data.route->priority;
 		return true;
-	
+		
 	/* NETLINK_ROUTE neighbor fields */
 	case FILTER_FIELD_NL_NEIGH_FAMILY:
 		if (!event->netlink.data.neigh)
@@ -359,10 +483,8 @@ static bool extract_field(struct nlmon_event *event, uint8_t field_type,
 	case FILTER_FIELD_NL_NEIGH_DST:
 		if (!event->netlink.data.neigh)
 			return false;
-		value->type = FILTER_VALUE_STRING;
-		value->data.string_val = strdup(event->netlink.data.neigh->dst);
-		return value->data.string_val != NULL;
-	
+		return value_set_field(value, event->netlink.data.neigh->dst);
+		
 	/* NETLINK_SOCK_DIAG fields */
 	case FILTER_FIELD_NL_DIAG_FAMILY:
 		if (!event->netlink.data.diag)
@@ -402,16 +524,12 @@ static bool extract_field(struct nlmon_event *event, uint8_t field_type,
 	case FILTER_FIELD_NL_DIAG_SRC_ADDR:
 		if (!event->netlink.data.diag)
 			return false;
-		value->type = FILTER_VALUE_STRING;
-		value->data.string_val = strdup(event->netlink.data.diag->src_addr);
-		return value->data.string_val != NULL;
+		return value_set_field(value, event->netlink.data.diag->src_addr);
 		
 	case FILTER_FIELD_NL_DIAG_DST_ADDR:
 		if (!event->netlink.data.diag)
 			return false;
-		value->type = FILTER_VALUE_STRING;
-		value->data.string_val = strdup(event->netlink.data.diag->dst_addr);
-		return value->data.string_val != NULL;
+		return value_set_field(value, event->netlink.data.diag->dst_addr);
 		
 	case FILTER_FIELD_NL_DIAG_UID:
 		if (!event->netlink.data.diag)
@@ -426,7 +544,7 @@ static bool extract_field(struct nlmon_event *event, uint8_t field_type,
 		value->type = FILTER_VALUE_NUMBER;
 		value->data.number_val = event->netlink.data.diag->inode;
 		return true;
-	
+		
 	/* NETLINK_NETFILTER conntrack fields */
 	case FILTER_FIELD_NL_CT_PROTOCOL:
 		if (!event->netlink.data.conntrack)
@@ -445,16 +563,12 @@ static bool extract_field(struct nlmon_event *event, uint8_t field_type,
 	case FILTER_FIELD_NL_CT_SRC_ADDR:
 		if (!event->netlink.data.conntrack)
 			return false;
-		value->type = FILTER_VALUE_STRING;
-		value->data.string_val = strdup(event->netlink.data.conntrack->src_addr);
-		return value->data.string_val != NULL;
+		return value_set_field(value, event->netlink.data.conntrack->src_addr);
 		
 	case FILTER_FIELD_NL_CT_DST_ADDR:
 		if (!event->netlink.data.conntrack)
 			return false;
-		value->type = FILTER_VALUE_STRING;
-		value->data.string_val = strdup(event->netlink.data.conntrack->dst_addr);
-		return value->data.string_val != NULL;
+		return value_set_field(value, event->netlink.data.conntrack->dst_addr);
 		
 	case FILTER_FIELD_NL_CT_SRC_PORT:
 		if (!event->netlink.data.conntrack)
@@ -476,7 +590,7 @@ static bool extract_field(struct nlmon_event *event, uint8_t field_type,
 		value->type = FILTER_VALUE_NUMBER;
 		value->data.number_val = event->netlink.data.conntrack->mark;
 		return true;
-	
+		
 	/* NETLINK_GENERIC nl80211 fields */
 	case FILTER_FIELD_NL_NL80211_CMD:
 		if (!event->netlink.data.nl80211)
@@ -502,9 +616,7 @@ static bool extract_field(struct nlmon_event *event, uint8_t field_type,
 	case FILTER_FIELD_NL_NL80211_IFNAME:
 		if (!event->netlink.data.nl80211)
 			return false;
-		value->type = FILTER_VALUE_STRING;
-		value->data.string_val = strdup(event->netlink.data.nl80211->ifname);
-		return value->data.string_val != NULL;
+		return value_set_field(value, event->netlink.data.nl80211->ifname);
 		
 	case FILTER_FIELD_NL_NL80211_IFTYPE:
 		if (!event->netlink.data.nl80211)
@@ -519,7 +631,7 @@ static bool extract_field(struct nlmon_event *event, uint8_t field_type,
 		value->type = FILTER_VALUE_NUMBER;
 		value->data.number_val = event->netlink.data.nl80211->freq;
 		return true;
-	
+		
 	/* QCA vendor fields */
 	case FILTER_FIELD_NL_QCA_SUBCMD:
 		if (!event->netlink.data.qca_vendor)
@@ -531,9 +643,7 @@ static bool extract_field(struct nlmon_event *event, uint8_t field_type,
 	case FILTER_FIELD_NL_QCA_SUBCMD_NAME:
 		if (!event->netlink.data.qca_vendor)
 			return false;
-		value->type = FILTER_VALUE_STRING;
-		value->data.string_val = strdup(event->netlink.data.qca_vendor->subcmd_name);
-		return value->data.string_val != NULL;
+		return value_set_field(value, event->netlink.data.qca_vendor->subcmd_name);
 		
 	case FILTER_FIELD_NL_QCA_VENDOR_ID:
 		if (!event->netlink.data.qca_vendor)
@@ -548,12 +658,34 @@ static bool extract_field(struct nlmon_event *event, uint8_t field_type,
 }
 
 /* Comparison operations */
+static int compare_strings(const struct filter_value *left,
+                           const struct filter_value *right)
+{
+	size_t llen = left->data.string_val.len;
+	size_t rlen = right->data.string_val.len;
+	int cmp = memcmp(left->data.string_val.ptr, right->data.string_val.ptr,
+	                 llen < rlen ? llen : rlen);
+	
+	if (cmp != 0)
+		return cmp;
+	return (llen > rlen) - (llen < rlen);
+}
+
 static bool compare_values(struct filter_value *left, struct filter_value *right,
                            enum filter_opcode op)
 {
 	/* Type coercion if needed */
 	if (left->type == FILTER_VALUE_STRING && right->type == FILTER_VALUE_STRING) {
-		int cmp = strcmp(left->data.string_val, right->data.string_val);
+		uint32_t latom = left->data.string_val.atom;
+		uint32_t ratom = right->data.string_val.atom;
+		
+		/* Atoms decide equality unless one side was never looked up */
+		if ((op == OP_EQ || op == OP_NE) &&
+		    latom != FILTER_ATOM_NONE && ratom != FILTER_ATOM_NONE &&
+		    (latom != FILTER_ATOM_ABSENT || ratom != FILTER_ATOM_ABSENT))
+			return (latom == ratom) == (op == OP_EQ);
+		
+		int cmp = compare_strings(left, right);
 		switch (op) {
 		case OP_EQ: return cmp == 0;
 		case OP_NE: return cmp != 0;
@@ -584,178 +716,389 @@ static bool compare_values(struct filter_value *left, struct filter_value *right
 }
 
 static bool match_regex(struct filter_eval_context *ctx,
-                        const char *text, const char *pattern)
+                        const struct filter_value *text,
+                        const struct filter_value *pattern)
 {
-	regex_t *regex = get_compiled_regex(ctx, pattern);
+	struct filter_regex *regex;
+	
+	regex = get_compiled_regex(ctx, pattern->data.string_val.ptr,
+	                           pattern->data.string_val.len);
 	if (!regex)
 		return false;
 	
-	return regexec(regex, text, 0, NULL, 0) == 0;
+	return filter_regex_match(regex, text->data.string_val.ptr,
+	                          text->data.string_val.len);
 }
 
-/* Bytecode evaluation */
-static bool eval_bytecode(struct filter_bytecode *bytecode,
-                          struct nlmon_event *event,
-                          struct filter_eval_context *ctx)
+/* Instruction implementations, shared by the interpreter and the JIT
+ *
+ * Each returns -1 on error and 0 otherwise, except op_test and op_return.
+ */
+static int op_push_field(struct filter_eval_context *ctx, struct filter_bytecode *bytecode,
+                         struct nlmon_event *event, const struct filter_instruction *instr)
+{
+	struct filter_value val;
+	
+	if (!extract_field(ctx, event, instr->operand.field.field_type, &val))
+		return -1;
+	return stack_push(ctx, val) ? 0 : -1;
+}
+
+static int op_push_string(struct filter_eval_context *ctx, struct filter_bytecode *bytecode,
+                          struct nlmon_event *event, const struct filter_instruction *instr)
+{
+	uint32_t index = instr->operand.string.string_index;
+	struct filter_value val;
+	
+	val.type = FILTER_VALUE_STRING;
+	val.data.string_val.ptr = bytecode->strings[index];
+	val.data.string_val.len = bytecode->string_lens[index];
+	val.data.string_val.atom = bytecode->string_atoms[index];
+	return stack_push(ctx, val) ? 0 : -1;
+}
+
+static int op_push_number(struct filter_eval_context *ctx, struct filter_bytecode *bytecode,
+                          struct nlmon_event *event, const struct filter_instruction *instr)
+{
+	struct filter_value val;
+	
+	val.type = FILTER_VALUE_NUMBER;
+	val.data.number_val = instr->operand.number.value;
+	return stack_push(ctx, val) ? 0 : -1;
+}
+
+static int op_pop(struct filter_eval_context *ctx, struct filter_bytecode *bytecode,
+                  struct nlmon_event *event, const struct filter_instruction *instr)
+{
+	struct filter_value val;
+	
+	return stack_pop(ctx, &val) ? 0 : -1;
+}
+
+static int push_bool(struct filter_eval_context *ctx, bool value)
 {
-	size_t pc = 0; /* Program counter */
 	struct filter_value result;
 	
+	result.type = FILTER_VALUE_BOOL;
+	result.data.bool_val = value;
+	return stack_push(ctx, result) ? 0 : -1;
+}
+
+static bool is_true(const struct filter_value *value)
+{
+	return value->type == FILTER_VALUE_BOOL && value->data.bool_val;
+}
+
+static int op_compare(struct filter_eval_context *ctx, struct filter_bytecode *bytecode,
+                      struct nlmon_event *event, const struct filter_instruction *instr)
+{
+	struct filter_value left, right;
+	
+	if (!stack_pop(ctx, &right) || !stack_pop(ctx, &left))
+		return -1;
+	return push_bool(ctx, compare_values(&left, &right, instr->opcode));
+}
+
+static int op_match(struct filter_eval_context *ctx, struct filter_bytecode *bytecode,
+                    struct nlmon_event *event, const struct filter_instruction *instr)
+{
+	struct filter_value left, right;
+	bool matches;
+	
+	if (!stack_pop(ctx, &right) || !stack_pop(ctx, &left))
+		return -1;
+	
+	if (left.type != FILTER_VALUE_STRING || right.type != FILTER_VALUE_STRING)
+		return push_bool(ctx, false);
+	
+	matches = match_regex(ctx, &left, &right);
+	return push_bool(ctx, instr->opcode == OP_MATCH ? matches : !matches);
+}
+
+static int op_in(struct filter_eval_context *ctx, struct filter_bytecode *bytecode,
+                 struct nlmon_event *event, const struct filter_instruction *instr)
+{
+	uint32_t count = instr->operand.in.count;
+	struct filter_value *items;
+	struct filter_value left;
+	bool found = false;
+	
+	/* List items sit above the value, compare them in place */
+	if (ctx->stack_size < (size_t)count + 1)
+		return -1;
+	
+	items = &ctx->stack[ctx->stack_size - count];
+	left = items[-1];
+	for (uint32_t i = 0; i < count; i++) {
+		if (compare_values(&left, &items[i], OP_EQ)) {
+			found = true;
+			break;
+		}
+	}
+	ctx->stack_size -= (size_t)count + 1;
+	
+	return push_bool(ctx, found);
+}
+
+static int op_in_set(struct filter_eval_context *ctx, struct filter_bytecode *bytecode,
+                     struct nlmon_event *event, const struct filter_instruction *instr)
+{
+	struct filter_value left;
+	uint32_t atom;
+	
+	if (!stack_pop(ctx, &left))
+		return -1;
+	
+	if (left.type != FILTER_VALUE_STRING)
+		return push_bool(ctx, false);
+	
+	atom = left.data.string_val.atom;
+	if (atom == FILTER_ATOM_NONE)
+		atom = filter_atom_lookup(left.data.string_val.ptr, left.data.string_val.len);
+	
+	return push_bool(ctx, filter_atom_set_contains(
+		&bytecode->sets[instr->operand.set.set_index], atom));
+}
+
+static int op_and(struct filter_eval_context *ctx, struct filter_bytecode *bytecode,
+                  struct nlmon_event *event, const struct filter_instruction *instr)
+{
+	struct filter_value left, right;
+	
+	if (!stack_pop(ctx, &right) || !stack_pop(ctx, &left))
+		return -1;
+	return push_bool(ctx, is_true(&left) && is_true(&right));
+}
+
+static int op_or(struct filter_eval_context *ctx, struct filter_bytecode *bytecode,
+                 struct nlmon_event *event, const struct filter_instruction *instr)
+{
+	struct filter_value left, right;
+	
+	if (!stack_pop(ctx, &right) || !stack_pop(ctx, &left))
+		return -1;
+	return push_bool(ctx, is_true(&left) || is_true(&right));
+}
+
+static int op_not(struct filter_eval_context *ctx, struct filter_bytecode *bytecode,
+                  struct nlmon_event *event, const struct filter_instruction *instr)
+{
+	struct filter_value left;
+	
+	if (!stack_pop(ctx, &left))
+		return -1;
+	return push_bool(ctx, !is_true(&left));
+}
+
+/* Superinstructions take field and constant as operands and push one result */
+static int op_field_cmp_number(struct filter_eval_context *ctx, struct filter_bytecode *bytecode,
+                               struct nlmon_event *event, const struct filter_instruction *instr)
+{
+	struct filter_value field, constant;
+	
+	if (!extract_field(ctx, event, instr->operand.fused.field_type, &field))
+		return -1;
+	
+	constant.type = FILTER_VALUE_NUMBER;
+	constant.data.number_val = instr->operand.fused.value;
+	return push_bool(ctx, compare_values(&field, &constant, instr->operand.fused.cmp));
+}
+
+static int op_field_cmp_string(struct filter_eval_context *ctx, struct filter_bytecode *bytecode,
+                               struct nlmon_event *event, const struct filter_instruction *instr)
+{
+	uint32_t index = instr->operand.fused.index;
+	struct filter_value field, constant;
+	bool matches;
+	
+	if (!extract_field(ctx, event, instr->operand.fused.field_type, &field))
+		return -1;
+	
+	constant.type = FILTER_VALUE_STRING;
+	constant.data.string_val.ptr = bytecode->strings[index];
+	constant.data.string_val.len = bytecode->string_lens[index];
+	constant.data.string_val.atom = bytecode->string_atoms[index];
+	
+	if (instr->operand.fused.cmp != OP_MATCH && instr->operand.fused.cmp != OP_NMATCH)
+		return push_bool(ctx, compare_values(&field, &constant, instr->operand.fused.cmp));
+	
+	if (field.type != FILTER_VALUE_STRING)
+		return push_bool(ctx, false);
+	
+	matches = match_regex(ctx, &field, &constant);
+	return push_bool(ctx, instr->operand.fused.cmp == OP_MATCH ? matches : !matches);
+}
+
+static int op_field_in_range(struct filter_eval_context *ctx, struct filter_bytecode *bytecode,
+                             struct nlmon_event *event, const struct filter_instruction *instr)
+{
+	struct filter_value field, lower, upper;
+	
+	if (!extract_field(ctx, event, instr->operand.fused.field_type, &field))
+		return -1;
+	
+	lower.type = FILTER_VALUE_NUMBER;
+	lower.data.number_val = instr->operand.fused.value;
+	upper.type = FILTER_VALUE_NUMBER;
+	upper.data.number_val = instr->operand.fused.upper;
+	return push_bool(ctx, compare_values(&field, &lower, OP_GE) &&
+	                      compare_values(&field, &upper, OP_LE));
+}
+
+static int op_field_in_set(struct filter_eval_context *ctx, struct filter_bytecode *bytecode,
+                           struct nlmon_event *event, const struct filter_instruction *instr)
+{
+	struct filter_value field;
+	uint32_t atom;
+	
+	if (!extract_field(ctx, event, instr->operand.fused.field_type, &field))
+		return -1;
+	
+	if (field.type != FILTER_VALUE_STRING)
+		return push_bool(ctx, false);
+	
+	atom = field.data.string_val.atom;
+	if (atom == FILTER_ATOM_NONE)
+		atom = filter_atom_lookup(field.data.string_val.ptr, field.data.string_val.len);
+	
+	return push_bool(ctx, filter_atom_set_contains(
+		&bytecode->sets[instr->operand.fused.index], atom));
+}
+
+static int op_call(struct filter_eval_context *ctx, struct filter_bytecode *bytecode,
+                   struct nlmon_event *event, const struct filter_instruction *instr)
+{
+	const char *string = NULL;
+	
+	if (instr->operand.call.arg == FILTER_PREDICATE_ARG_STRING)
+		string = bytecode->strings[instr->operand.call.string_index];
+	return push_bool(ctx, filter_predicate_call(instr->operand.call.predicate, event,
+	                                            string, instr->operand.call.number));
+}
+
+/* Top of the stack for the conditional jumps: 0 false, 1 true, 2 not a bool */
+static int op_test(struct filter_eval_context *ctx, struct filter_bytecode *bytecode,
+                   struct nlmon_event *event, const struct filter_instruction *instr)
+{
+	struct filter_value val;
+	
+	if (!stack_peek(ctx, &val))
+		return -1;
+	if (val.type != FILTER_VALUE_BOOL)
+		return 2;
+	return val.data.bool_val;
+}
+
+/* Pop the result for OP_RETURN and falling off the end: 1 match, 0 none */
+static int op_return(struct filter_eval_context *ctx, struct filter_bytecode *bytecode,
+                     struct nlmon_event *event, const struct filter_instruction *instr)
+{
+	struct filter_value result;
+	
+	if (!stack_pop(ctx, &result))
+		return -1;
+	return is_true(&result);
+}
+
+filter_op_fn filter_eval_op(enum filter_opcode opcode)
+{
+	switch (opcode) {
+	case OP_PUSH_FIELD: return op_push_field;
+	case OP_PUSH_STRING: return op_push_string;
+	case OP_PUSH_NUMBER: return op_push_number;
+	case OP_POP: return op_pop;
+	case OP_EQ:
+	case OP_NE:
+	case OP_LT:
+	case OP_GT:
+	case OP_LE:
+	case OP_GE: return op_compare;
+	case OP_MATCH:
+	case OP_NMATCH: return op_match;
+	case OP_IN: return op_in;
+	case OP_IN_SET: return op_in_set;
+	case OP_AND: return op_and;
+	case OP_OR: return op_or;
+	case OP_NOT: return op_not;
+	case OP_FIELD_CMP_NUMBER: return op_field_cmp_number;
+	case OP_FIELD_CMP_STRING: return op_field_cmp_string;
+	case OP_FIELD_IN_RANGE: return op_field_in_range;
+	case OP_FIELD_IN_SET: return op_field_in_set;
+	case OP_CALL: return op_call;
+	case OP_JUMP_IF_FALSE:
+	case OP_JUMP_IF_TRUE: return op_test;
+	case OP_RETURN: return op_return;
+	default: return NULL;
+	}
+}
+
+/* Bytecode evaluation, returns -1 on error, else whether the event matches */
+static int eval_bytecode(struct filter_bytecode *bytecode,
+                         struct nlmon_event *event,
+                         struct filter_eval_context *ctx)
+{
+	size_t pc = 0; /* Program counter */
+	int ret;
+	
 	while (pc < bytecode->instruction_count) {
 		struct filter_instruction *instr = &bytecode->instructions[pc];
-		struct filter_value val, left, right;
+		
+		ctx->opcode_counts[instr->opcode]++;
 		
 		switch (instr->opcode) {
 		case OP_PUSH_FIELD:
-			if (!extract_field(event, instr->operand.field.field_type, &val))
-				return false;
-			if (!stack_push(ctx, val)) {
-				value_free(&val);
-				return false;
-			}
+			ret = op_push_field(ctx, bytecode, event, instr);
 			break;
-			
 		case OP_PUSH_STRING:
-			val.type = FILTER_VALUE_STRING;
-			val.data.string_val = strdup(bytecode->strings[instr->operand.string.string_index]);
-			if (!val.data.string_val)
-				return false;
-			if (!stack_push(ctx, val)) {
-				value_free(&val);
-				return false;
-			}
+			ret = op_push_string(ctx, bytecode, event, instr);
 			break;
-			
 		case OP_PUSH_NUMBER:
-			val.type = FILTER_VALUE_NUMBER;
-			val.data.number_val = instr->operand.number.value;
-			if (!stack_push(ctx, val))
-				return false;
+			ret = op_push_number(ctx, bytecode, event, instr);
 			break;
-			
 		case OP_POP:
-			if (!stack_pop(ctx, &val))
-				return false;
-			value_free(&val);
+			ret = op_pop(ctx, bytecode, event, instr);
 			break;
-			
 		case OP_EQ:
 		case OP_NE:
 		case OP_LT:
 		case OP_GT:
 		case OP_LE:
 		case OP_GE:
-			if (!stack_pop(ctx, &right) || !stack_pop(ctx, &left))
-				return false;
-			
-			result.type = FILTER_VALUE_BOOL;
-			result.data.bool_val = compare_values(&left, &right, instr->opcode);
-			
-			value_free(&left);
-			value_free(&right);
-			
-			if (!stack_push(ctx, result))
-				return false;
+			ret = op_compare(ctx, bytecode, event, instr);
 			break;
-			
 		case OP_MATCH:
 		case OP_NMATCH:
-			if (!stack_pop(ctx, &right) || !stack_pop(ctx, &left))
-				return false;
-			
-			result.type = FILTER_VALUE_BOOL;
-			if (left.type == FILTER_VALUE_STRING && right.type == FILTER_VALUE_STRING) {
-				bool matches = match_regex(ctx, left.data.string_val, right.data.string_val);
-				result.data.bool_val = (instr->opcode == OP_MATCH) ? matches : !matches;
-			} else {
-				result.data.bool_val = false;
-			}
-			
-			value_free(&left);
-			value_free(&right);
-			
-			if (!stack_push(ctx, result))
-				return false;
+			ret = op_match(ctx, bytecode, event, instr);
 			break;
-			
-		case OP_IN: {
-			/* Pop all list items first (they're on top of stack) */
-			struct filter_value *list_items = malloc(instr->operand.in.count * sizeof(struct filter_value));
-			if (!list_items)
-				return false;
-			
-			for (uint32_t i = 0; i < instr->operand.in.count; i++) {
-				if (!stack_pop(ctx, &list_items[instr->operand.in.count - 1 - i])) {
-					for (uint32_t j = 0; j < i; j++)
-						value_free(&list_items[instr->operand.in.count - 1 - j]);
-					free(list_items);
-					return false;
-				}
-			}
-			
-			/* Now pop the value to check */
-			if (!stack_pop(ctx, &left)) {
-				for (uint32_t i = 0; i < instr->operand.in.count; i++)
-					value_free(&list_items[i]);
-				free(list_items);
-				return false;
-			}
-			
-			/* Check for match */
-			bool found = false;
-			for (uint32_t i = 0; i < instr->operand.in.count; i++) {
-				if (compare_values(&left, &list_items[i], OP_EQ)) {
-					found = true;
-					break;
-				}
-			}
-			
-			/* Cleanup */
-			value_free(&left);
-			for (uint32_t i = 0; i < instr->operand.in.count; i++)
-				value_free(&list_items[i]);
-			free(list_items);
-			
-			result.type = FILTER_VALUE_BOOL;
-			result.data.bool_val = found;
-			if (!stack_push(ctx, result))
-				return false;
+		case OP_IN:
+			ret = op_in(ctx, bytecode, event, instr);
+			break;
+		case OP_IN_SET:
+			ret = op_in_set(ctx, bytecode, event, instr);
 			break;
-		}
-			
 		case OP_AND:
-			if (!stack_pop(ctx, &right) || !stack_pop(ctx, &left))
-				return false;
-			
-			result.type = FILTER_VALUE_BOOL;
-			result.data.bool_val = (left.type == FILTER_VALUE_BOOL && left.data.bool_val) &&
-			                       (right.type == FILTER_VALUE_BOOL && right.data.bool_val);
-			
-			if (!stack_push(ctx, result))
-				return false;
+			ret = op_and(ctx, bytecode, event, instr);
 			break;
-			
 		case OP_OR:
-			if (!stack_pop(ctx, &right) || !stack_pop(ctx, &left))
-				return false;
-			
-			result.type = FILTER_VALUE_BOOL;
-			result.data.bool_val = (left.type == FILTER_VALUE_BOOL && left.data.bool_val) ||
-			                       (right.type == FILTER_VALUE_BOOL && right.data.bool_val);
-			
-			if (!stack_push(ctx, result))
-				return false;
+			ret = op_or(ctx, bytecode, event, instr);
 			break;
-			
 		case OP_NOT:
-			if (!stack_pop(ctx, &left))
-				return false;
-			
-			result.type = FILTER_VALUE_BOOL;
-			result.data.bool_val = !(left.type == FILTER_VALUE_BOOL && left.data.bool_val);
-			
-			if (!stack_push(ctx, result))
-				return false;
+			ret = op_not(ctx, bytecode, event, instr);
+			break;
+		case OP_FIELD_CMP_NUMBER:
+			ret = op_field_cmp_number(ctx, bytecode, event, instr);
+			break;
+		case OP_FIELD_CMP_STRING:
+			ret = op_field_cmp_string(ctx, bytecode, event, instr);
+			break;
+		case OP_FIELD_IN_RANGE:
+			ret = op_field_in_range(ctx, bytecode, event, instr);
+			break;
+		case OP_FIELD_IN_SET:
+			ret = op_field_in_set(ctx, bytecode, event, instr);
+			break;
+		case OP_CALL:
+			ret = op_call(ctx, bytecode, event, instr);
 			break;
 			
 		case OP_JUMP:
@@ -763,43 +1106,31 @@ static bool eval_bytecode(struct filter_bytecode *bytecode,
 			continue;
 			
 		case OP_JUMP_IF_FALSE:
-			if (!stack_peek(ctx, &val))
-				return false;
-			if (val.type == FILTER_VALUE_BOOL && !val.data.bool_val)
-				pc += instr->operand.jump.offset;
-			break;
-			
 		case OP_JUMP_IF_TRUE:
-			if (!stack_peek(ctx, &val))
-				return false;
-			if (val.type == FILTER_VALUE_BOOL && val.data.bool_val)
+			ret = op_test(ctx, bytecode, event, instr);
+			if (ret < 0)
+				return -1;
+			if (ret == (instr->opcode == OP_JUMP_IF_TRUE ? 1 : 0))
 				pc += instr->operand.jump.offset;
 			break;
 			
 		case OP_RETURN:
-			if (!stack_pop(ctx, &result))
-				return false;
-			
-			bool ret = (result.type == FILTER_VALUE_BOOL && result.data.bool_val);
-			value_free(&result);
-			return ret;
+			return op_return(ctx, bytecode, event, instr);
 			
 		case OP_NOP:
+		default:
 			/* No operation */
+			ret = 0;
 			break;
 		}
 		
+		if (ret < 0)
+			return -1;
 		pc++;
 	}
 	
 	/* No explicit return, check top of stack */
-	if (stack_pop(ctx, &result)) {
-		bool ret = (result.type == FILTER_VALUE_BOOL && result.data.bool_val);
-		value_free(&result);
-		return ret;
-	}
-	
-	return false;
+	return op_return(ctx, bytecode, event, NULL);
 }
 
 /* Public API */
@@ -816,20 +1147,19 @@ struct filter_eval_context *filter_eval_context_create(void)
 		return NULL;
 	}
 	
-	ctx->regex_cache_capacity = INITIAL_REGEX_CACHE_CAPACITY;
-	ctx->regex_cache = calloc(ctx->regex_cache_capacity, sizeof(*ctx->regex_cache));
-	if (!ctx->regex_cache) {
+	if (!regex_cache_alloc(ctx, FILTER_EVAL_REGEX_CACHE_DEFAULT)) {
 		free(ctx->stack);
 		free(ctx);
 		return NULL;
 	}
 	
-	/* Allocate opcode statistics arrays (assuming max 32 opcodes) */
-	ctx->opcode_counts = calloc(32, sizeof(uint64_t));
-	ctx->opcode_times = calloc(32, sizeof(uint64_t));
+	/* Allocate opcode statistics arrays */
+	ctx->opcode_counts = calloc(MAX_OPCODES, sizeof(uint64_t));
+	ctx->opcode_times = calloc(MAX_OPCODES, sizeof(uint64_t));
 	if (!ctx->opcode_counts || !ctx->opcode_times) {
 		free(ctx->opcode_times);
 		free(ctx->opcode_counts);
+		free(ctx->regex_buckets);
 		free(ctx->regex_cache);
 		free(ctx->stack);
 		free(ctx);
@@ -846,18 +1176,11 @@ void filter_eval_context_destroy(struct filter_eval_context *ctx)
 	if (!ctx)
 		return;
 	
-	/* Free stack values */
-	for (size_t i = 0; i < ctx->stack_size; i++)
-		value_free(&ctx->stack[i]);
 	free(ctx->stack);
 	
 	/* Free regex cache */
-	for (size_t i = 0; i < ctx->regex_cache_size; i++) {
-		if (ctx->regex_cache[i].valid) {
-			regfree(&ctx->regex_cache[i].compiled);
-			free(ctx->regex_cache[i].pattern);
-		}
-	}
+	regex_cache_flush(ctx);
+	free(ctx->regex_buckets);
 	free(ctx->regex_cache);
 	
 	free(ctx->opcode_counts);
@@ -865,38 +1188,519 @@ void filter_eval_context_destroy(struct filter_eval_context *ctx)
 	free(ctx);
 }
 
+/* Context for callers without one, kept per thread with its regex cache */
+static pthread_key_t thread_ctx_key;
+static pthread_once_t thread_ctx_once = PTHREAD_ONCE_INIT;
+
+static void thread_ctx_destroy(void *ctx)
+{
+	filter_eval_context_destroy(ctx);
+}
+
+static void thread_ctx_init(void)
+{
+	pthread_key_create(&thread_ctx_key, thread_ctx_destroy);
+}
+
+static struct filter_eval_context *thread_ctx(void)
+{
+	struct filter_eval_context *ctx;
+	
+	pthread_once(&thread_ctx_once, thread_ctx_init);
+	
+	ctx = pthread_getspecific(thread_ctx_key);
+	if (!ctx) {
+		ctx = filter_eval_context_create();
+		if (ctx && pthread_setspecific(thread_ctx_key, ctx) != 0) {
+			filter_eval_context_destroy(ctx);
+			ctx = NULL;
+		}
+	}
+	
+	return ctx;
+}
+
 bool filter_eval(struct filter_bytecode *bytecode,
                  struct nlmon_event *event,
                  struct filter_eval_context *ctx)
 {
-	struct filter_eval_context *local_ctx = ctx;
 	bool result;
 	
 	if (!bytecode || !event)
 		return false;
 	
-	/* Create temporary context if none provided */
-	if (!local_ctx) {
-		local_ctx = filter_eval_context_create();
-		if (!local_ctx)
+	if (!ctx) {
+		ctx = thread_ctx();
+		if (!ctx)
 			return false;
 	}
 	
-	/* Reset stack */
-	for (size_t i = 0; i < local_ctx->stack_size; i++)
-		value_free(&local_ctx->stack[i]);
-	local_ctx->stack_size = 0;
+	/* Reset stack, values only borrow so nothing to free */
+	ctx->stack_size = 0;
 	
-	/* Evaluate */
-	result = eval_bytecode(bytecode, event, local_ctx);
+	NLMON_PROBE1(filter_start, event->event_type);
 	
-	/* Cleanup temporary context */
-	if (!ctx)
-		filter_eval_context_destroy(local_ctx);
+	/* Evaluate, natively if the filter was compiled */
+	if (!filter_jit_run(bytecode, event, ctx, &result))
+		result = eval_bytecode(bytecode, event, ctx) > 0;
 	
+	NLMON_PROBE1(filter_done, result);
 	return result;
 }
 
+int filter_eval_predicate(struct filter_bytecode *bytecode,
+                          struct nlmon_event *event,
+                          struct filter_eval_context *ctx)
+{
+	if (!bytecode || !event || !ctx)
+		return -1;
+	
+	ctx->stack_size = 0;
+	return eval_bytecode(bytecode, event, ctx);
+}
+
+bool filter_eval_field(struct filter_eval_context *ctx, struct nlmon_event *event,
+                       uint8_t field_type, struct filter_value *value)
+{
+	if (!ctx || !event || !value)
+		return false;
+	
+	return extract_field(ctx, event, field_type, value);
+}
+
+/* Batch evaluation
+ *
+ * Up to BATCH_LANES events run through the bytecode together, one bit
+ * each in a lane mask. Every instruction executes once for all the lanes
+ * reaching it, on one column of values per stack slot. That needs each
+ * instruction to see the same stack depth in every lane, which holds for
+ * compiled filters: jumps only go forward and both sides of a branch
+ * leave the same depth. Other bytecode is evaluated one event at a time.
+ */
+#define BATCH_LANES 64
+#define BATCH_MAX_DEPTH 16
+
+struct batch_plan {
+	int *depth;                     /* Stack depth at each instruction, -1 if unreached */
+	uint64_t *active;               /* Lanes reaching each instruction */
+	struct filter_value columns[BATCH_MAX_DEPTH][BATCH_LANES];
+};
+
+#define for_each_lane(i, mask, m) \
+	for (uint64_t m = (mask); m && ((i) = (size_t)__builtin_ctzll(m), 1); m &= m - 1)
+
+/* Values an instruction pops and pushes, jumps are handled separately */
+static void batch_effect(const struct filter_instruction *instr, int *pops, int *pushes)
+{
+	*pops = 0;
+	*pushes = 1;
+	
+	switch (instr->opcode) {
+	case OP_PUSH_FIELD:
+	case OP_PUSH_STRING:
+	case OP_PUSH_NUMBER:
+	case OP_FIELD_CMP_NUMBER:
+	case OP_FIELD_CMP_STRING:
+	case OP_FIELD_IN_RANGE:
+	case OP_FIELD_IN_SET:
+	case OP_CALL:
+		break;
+	case OP_EQ:
+	case OP_NE:
+	case OP_LT:
+	case OP_GT:
+	case OP_LE:
+	case OP_GE:
+	case OP_MATCH:
+	case OP_NMATCH:
+	case OP_AND:
+	case OP_OR:
+		*pops = 2;
+		break;
+	case OP_IN:
+		*pops = (int)instr->operand.in.count + 1;
+		break;
+	case OP_IN_SET:
+	case OP_NOT:
+		*pops = 1;
+		break;
+	case OP_POP:
+	case OP_RETURN:
+		*pops = 1;
+		*pushes = 0;
+		break;
+	default:
+		*pushes = 0;
+		break;
+	}
+}
+
+/* Record the depth a jump or fall through arrives with, false on a conflict */
+static bool batch_reach(struct batch_plan *plan, size_t count, int64_t target, int depth)
+{
+	if ((uint64_t)target > count)
+		target = (int64_t)count;
+	
+	if (plan->depth[target] >= 0 && plan->depth[target] != depth)
+		return false;
+	plan->depth[target] = depth;
+	return true;
+}
+
+static void batch_plan_destroy(struct batch_plan *plan)
+{
+	if (!plan)
+		return;
+	
+	free(plan->depth);
+	free(plan->active);
+	free(plan);
+}
+
+/* Depth of every instruction, NULL if the bytecode cannot run in lanes */
+static struct batch_plan *batch_plan_create(const struct filter_bytecode *bytecode)
+{
+	size_t count = bytecode->instruction_count;
+	struct batch_plan *plan;
+	int pops, pushes, depth;
+	int64_t target;
+	
+	plan = malloc(sizeof(*plan));
+	if (!plan)
+		return NULL;
+	
+	plan->depth = malloc((count + 1) * sizeof(*plan->depth));
+	plan->active = malloc((count + 1) * sizeof(*plan->active));
+	if (!plan->depth || !plan->active)
+		goto err;
+	
+	for (size_t i = 0; i <= count; i++)
+		plan->depth[i] = -1;
+	plan->depth[0] = 0;
+	
+	for (size_t pc = 0; pc < count; pc++) {
+		const struct filter_instruction *instr = &bytecode->instructions[pc];
+		
+		depth = plan->depth[pc];
+		if (depth < 0)
+			continue;
+		
+		switch (instr->opcode) {
+		case OP_JUMP:
+			target = (int64_t)pc + instr->operand.jump.offset;
+			if (target <= (int64_t)pc || !batch_reach(plan, count, target, depth))
+				goto err;
+			continue;
+			
+		case OP_JUMP_IF_FALSE:
+		case OP_JUMP_IF_TRUE:
+			target = (int64_t)pc + instr->operand.jump.offset + 1;
+			if (depth < 1 || target <= (int64_t)pc ||
+			    !batch_reach(plan, count, target, depth))
+				goto err;
+			break;
+			
+		case OP_RETURN:
+			continue;
+			
+		default:
+			batch_effect(instr, &pops, &pushes);
+			if (depth < pops)
+				goto err;
+			depth += pushes - pops;
+			if (depth > BATCH_MAX_DEPTH)
+				goto err;
+			break;
+		}
+		
+		if (!batch_reach(plan, count, (int64_t)pc + 1, depth))
+			goto err;
+	}
+	
+	return plan;
+	
+err:
+	batch_plan_destroy(plan);
+	return NULL;
+}
+
+/* Lanes whose top of stack is the bool value */
+static uint64_t batch_test(const struct filter_value *column, uint64_t mask, bool value)
+{
+	uint64_t taken = 0;
+	size_t i;
+	
+	for_each_lane(i, mask, m) {
+		if (column[i].type == FILTER_VALUE_BOOL && column[i].data.bool_val == value)
+			taken |= 1ULL << i;
+	}
+	
+	return taken;
+}
+
+/* Lanes returning true, a missing result is an error and so no match */
+static uint64_t batch_return(const struct batch_plan *plan, int depth, uint64_t mask)
+{
+	uint64_t matched = 0;
+	size_t i;
+	
+	if (depth < 1)
+		return 0;
+	
+	for_each_lane(i, mask, m) {
+		if (is_true(&plan->columns[depth - 1][i]))
+			matched |= 1ULL << i;
+	}
+	
+	return matched;
+}
+
+/* Straight loops over the column, one per operator, so they vectorize */
+#define BATCH_COMPARE(bits, numbers, expr) \
+	for (size_t i = 0; i < BATCH_LANES; i++) { \
+		int64_t n = (numbers)[i]; \
+		(bits) |= (uint64_t)(expr) << i; \
+	}
+
+static uint64_t batch_compare(const int64_t *numbers, enum filter_opcode cmp, int64_t value)
+{
+	uint64_t bits = 0;
+	
+	switch (cmp) {
+	case OP_EQ: BATCH_COMPARE(bits, numbers, n == value); break;
+	case OP_NE: BATCH_COMPARE(bits, numbers, n != value); break;
+	case OP_LT: BATCH_COMPARE(bits, numbers, n < value); break;
+	case OP_GT: BATCH_COMPARE(bits, numbers, n > value); break;
+	case OP_LE: BATCH_COMPARE(bits, numbers, n <= value); break;
+	case OP_GE: BATCH_COMPARE(bits, numbers, n >= value); break;
+	default: break;
+	}
+	
+	return bits;
+}
+
+/* OP_FIELD_CMP_NUMBER and OP_FIELD_IN_RANGE, returns the lanes without error */
+static uint64_t batch_field_number(struct filter_value *column, struct filter_eval_context *ctx,
+                                   struct nlmon_event **events, uint64_t mask,
+                                   const struct filter_instruction *instr)
+{
+	int64_t numbers[BATCH_LANES] = { 0 };
+	uint64_t ok = 0, is_number = 0, hits;
+	struct filter_value value;
+	size_t i;
+	
+	/* Gather the field into a column, then compare all lanes at once */
+	for_each_lane(i, mask, m) {
+		if (!extract_field(ctx, events[i], instr->operand.fused.field_type, &value))
+			continue;
+		ok |= 1ULL << i;
+		if (value.type == FILTER_VALUE_NUMBER) {
+			is_number |= 1ULL << i;
+			numbers[i] = value.data.number_val;
+		}
+	}
+	
+	if (instr->opcode == OP_FIELD_IN_RANGE)
+		hits = batch_compare(numbers, OP_GE, instr->operand.fused.value) &
+		       batch_compare(numbers, OP_LE, instr->operand.fused.upper);
+	else
+		hits = batch_compare(numbers, instr->operand.fused.cmp, instr->operand.fused.value);
+	
+	/* Other types never equal a number */
+	hits &= is_number;
+	
+	for_each_lane(i, ok, m) {
+		column[i].type = FILTER_VALUE_BOOL;
+		column[i].data.bool_val = (hits >> i) & 1;
+	}
+	
+	return ok;
+}
+
+/* Pushes straight into the column, returns the lanes without error */
+static uint64_t batch_push(struct filter_value *column, struct filter_eval_context *ctx,
+                           struct filter_bytecode *bytecode, struct nlmon_event **events,
+                           uint64_t mask, const struct filter_instruction *instr)
+{
+	uint32_t index = instr->operand.string.string_index;
+	struct filter_value constant;
+	size_t i;
+	
+	if (instr->opcode == OP_PUSH_FIELD) {
+		for_each_lane(i, mask, m) {
+			if (!extract_field(ctx, events[i], instr->operand.field.field_type, &column[i]))
+				mask &= ~(1ULL << i);
+		}
+		return mask;
+	}
+	
+	if (instr->opcode == OP_PUSH_NUMBER) {
+		constant.type = FILTER_VALUE_NUMBER;
+		constant.data.number_val = instr->operand.number.value;
+	} else {
+		constant.type = FILTER_VALUE_STRING;
+		constant.data.string_val.ptr = bytecode->strings[index];
+		constant.data.string_val.len = bytecode->string_lens[index];
+		constant.data.string_val.atom = bytecode->string_atoms[index];
+	}
+	
+	for_each_lane(i, mask, m)
+		column[i] = constant;
+	return mask;
+}
+
+/* Any other instruction, lane by lane on the context stack */
+static uint64_t batch_scalar(struct batch_plan *plan, struct filter_eval_context *ctx,
+                             struct filter_bytecode *bytecode, struct nlmon_event **events,
+                             uint64_t mask, int depth, const struct filter_instruction *instr)
+{
+	filter_op_fn fn = filter_eval_op(instr->opcode);
+	int pops, pushes, base;
+	size_t i;
+	
+	if (!fn)
+		return mask;
+	
+	batch_effect(instr, &pops, &pushes);
+	base = depth - pops;
+	
+	/* The stack never shrinks below INITIAL_STACK_CAPACITY values */
+	for_each_lane(i, mask, m) {
+		for (int s = 0; s < pops; s++)
+			ctx->stack[s] = plan->columns[base + s][i];
+		ctx->stack_size = (size_t)pops;
+		
+		if (fn(ctx, bytecode, events[i], instr) < 0) {
+			mask &= ~(1ULL << i);
+			continue;
+		}
+		
+		for (int s = 0; s < pushes; s++)
+			plan->columns[base + s][i] = ctx->stack[s];
+	}
+	
+	return mask;
+}
+
+/* Run up to BATCH_LANES events, returns the lanes matching */
+static uint64_t batch_run(struct batch_plan *plan, struct filter_bytecode *bytecode,
+                          struct nlmon_event **events, uint64_t lanes,
+                          struct filter_eval_context *ctx)
+{
+	size_t count = bytecode->instruction_count;
+	uint64_t matched = 0, mask, taken;
+	int64_t target;
+	int depth;
+	
+	memset(plan->active, 0, (count + 1) * sizeof(*plan->active));
+	plan->active[0] = lanes;
+	
+	for (size_t pc = 0; pc < count; pc++) {
+		const struct filter_instruction *instr = &bytecode->instructions[pc];
+		
+		mask = plan->active[pc];
+		if (!mask)
+			continue;
+		depth = plan->depth[pc];
+		
+		ctx->opcode_counts[instr->opcode]++;
+		
+		switch (instr->opcode) {
+		case OP_JUMP:
+			target = (int64_t)pc + instr->operand.jump.offset;
+			plan->active[target < (int64_t)count ? (size_t)target : count] |= mask;
+			continue;
+			
+		case OP_JUMP_IF_FALSE:
+		case OP_JUMP_IF_TRUE:
+			taken = batch_test(plan->columns[depth - 1], mask,
+			                   instr->opcode == OP_JUMP_IF_TRUE);
+			target = (int64_t)pc + instr->operand.jump.offset + 1;
+			plan->active[target < (int64_t)count ? (size_t)target : count] |= taken;
+			mask &= ~taken;
+			break;
+			
+		case OP_RETURN:
+			matched |= batch_return(plan, depth, mask);
+			continue;
+			
+		case OP_FIELD_CMP_NUMBER:
+		case OP_FIELD_IN_RANGE:
+			mask = batch_field_number(plan->columns[depth], ctx, events, mask, instr);
+			break;
+			
+		case OP_PUSH_FIELD:
+		case OP_PUSH_STRING:
+		case OP_PUSH_NUMBER:
+			mask = batch_push(plan->columns[depth], ctx, bytecode, events, mask, instr);
+			break;
+			
+		case OP_POP:
+		case OP_NOP:
+			/* The depth of the next instruction already drops the value */
+			break;
+			
+		default:
+			mask = batch_scalar(plan, ctx, bytecode, events, mask, depth, instr);
+			break;
+		}
+		
+		plan->active[pc + 1] |= mask;
+	}
+	
+	/* Lanes falling off the end return their top of stack */
+	return matched | batch_return(plan, plan->depth[count], plan->active[count]);
+}
+
+size_t filter_eval_batch(struct filter_bytecode *bytecode, struct nlmon_event **events,
+                         size_t count, struct filter_eval_context *ctx, uint64_t *matches)
+{
+	struct batch_plan *plan;
+	size_t matched = 0;
+	
+	if (!matches)
+		return 0;
+	memset(matches, 0, (count + BATCH_LANES - 1) / BATCH_LANES * sizeof(*matches));
+	
+	if (!bytecode || !events || count == 0)
+		return 0;
+	
+	if (!ctx) {
+		ctx = thread_ctx();
+		if (!ctx)
+			return 0;
+	}
+	
+	plan = batch_plan_create(bytecode);
+	
+	for (size_t base = 0; base < count; base += BATCH_LANES) {
+		size_t n = count - base < BATCH_LANES ? count - base : BATCH_LANES;
+		uint64_t lanes = 0, bits = 0;
+		
+		for (size_t i = 0; i < n; i++) {
+			if (events[base + i])
+				lanes |= 1ULL << i;
+		}
+		
+		if (plan) {
+			bits = batch_run(plan, bytecode, events + base, lanes, ctx);
+		} else {
+			size_t i;
+			
+			for_each_lane(i, lanes, m) {
+				if (filter_eval(bytecode, events[base + i], ctx))
+					bits |= 1ULL << i;
+			}
+		}
+		
+		matches[base / BATCH_LANES] = bits;
+		matched += (size_t)__builtin_popcountll(bits);
+	}
+	
+	batch_plan_destroy(plan);
+	return matched;
+}
+
 bool filter_eval_with_profiling(struct filter_bytecode *bytecode,
                                  struct nlmon_event *event,
                                  struct filter_eval_context *ctx,
@@ -904,11 +1708,19 @@ bool filter_eval_with_profiling(struct filter_bytecode *bytecode,
 {
 	struct timespec start, end;
 	bool result;
-	uint64_t elapsed;
+	uint64_t elapsed, threshold;
 	
 	if (!bytecode || !event || !ctx)
 		return false;
 	
+	/* Compile filters once they prove hot */
+	threshold = filter_jit_threshold();
+	if (threshold && !bytecode->jit_attempted &&
+	    ++bytecode->profiled_evals >= threshold) {
+		bytecode->jit_attempted = true;
+		filter_jit_compile(bytecode);
+	}
+	
 	clock_gettime(CLOCK_MONOTONIC, &start);
 	result = filter_eval(bytecode, event, ctx);
 	clock_gettime(CLOCK_MONOTONIC, &end);
@@ -959,8 +1771,33 @@ void filter_eval_reset_stats(struct filter_eval_context *ctx)
 	ctx->min_time_ns = UINT64_MAX;
 	ctx->max_time_ns = 0;
 	
-	memset(ctx->opcode_counts, 0, 32 * sizeof(uint64_t));
-	memset(ctx->opcode_times, 0, 32 * sizeof(uint64_t));
+	ctx->regex_stats.hits = 0;
+	ctx->regex_stats.misses = 0;
+	ctx->regex_stats.compiles = 0;
+	ctx->regex_stats.evictions = 0;
+	
+	memset(ctx->opcode_counts, 0, MAX_OPCODES * sizeof(uint64_t));
+	memset(ctx->opcode_times, 0, MAX_OPCODES * sizeof(uint64_t));
+}
+
+bool filter_eval_set_regex_cache_size(struct filter_eval_context *ctx, size_t entries)
+{
+	if (!ctx || entries == 0 || entries >= REGEX_NONE)
+		return false;
+	
+	regex_cache_flush(ctx);
+	return regex_cache_alloc(ctx, entries);
+}
+
+void filter_eval_regex_stats(struct filter_eval_context *ctx,
+                             struct filter_regex_stats *stats)
+{
+	if (!ctx || !stats)
+		return;
+	
+	*stats = ctx->regex_stats;
+	stats->entries = ctx->regex_cache_size;
+	stats->capacity = ctx->regex_cache_capacity;
 }
 
 void filter_eval_opcode_stats(struct filter_eval_context *ctx,
@@ -968,7 +1805,7 @@ void filter_eval_opcode_stats(struct filter_eval_context *ctx,
                               uint64_t *count,
                               uint64_t *total_time_ns)
 {
-	if (!ctx || opcode < 0 || opcode >= 32)
+	if (!ctx || opcode < 0 || opcode >= MAX_OPCODES)
 		return;
 	
 	if (count)
@@ -0,0 +1,327 @@
+/* filter_jit.c - Native code backend for filter bytecode
+ *
+ * Generated code is call threaded: each instruction becomes a direct
+ * call of its implementation in filter_eval.c and jumps become native
+ * branches, so the interpreter's per instruction dispatch disappears
+ * while the semantics stay those of the interpreter. Code is written
+ * into an anonymous mapping that is made executable, never both
+ * writable and executable at once.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "filter_jit.h"
+#include "filter_eval.h"
+
+/* Generated code of one bytecode */
+struct filter_jit {
+	filter_jit_fn fn;
+	void *mem;
+	size_t size;
+};
+
+static _Atomic uint64_t jit_threshold = FILTER_JIT_DEFAULT_THRESHOLD;
+
+void filter_jit_set_threshold(uint64_t evals)
+{
+	atomic_store(&jit_threshold, evals);
+}
+
+uint64_t filter_jit_threshold(void)
+{
+	return atomic_load(&jit_threshold);
+}
+
+void filter_jit_release(struct filter_bytecode *bytecode)
+{
+	struct filter_jit *jit;
+	
+	if (!bytecode)
+		return;
+	
+	jit = atomic_exchange(&bytecode->jit, NULL);
+	if (!jit)
+		return;
+	
+	munmap(jit->mem, jit->size);
+	free(jit);
+}
+
+/* FILTER_JIT_DISABLE builds the fallback on any target, for testing it */
+#if defined(__x86_64__) && !defined(FILTER_JIT_DISABLE)
+
+/* Longest code of one instruction: call sequence plus two branches */
+#define JIT_MAX_INSN_BYTES 64
+
+/* Prologue, end of program, failure and exit */
+#define JIT_FIXED_BYTES 128
+
+struct jit_fixup {
+	size_t pos;                     /* Offset of a rel32 */
+	size_t target;                  /* Label index */
+};
+
+struct jit_buf {
+	uint8_t *code;
+	size_t len;
+	size_t *labels;                 /* Instructions, then end, fail and exit */
+	struct jit_fixup *fixups;
+	size_t fixup_count;
+};
+
+static void emit(struct jit_buf *buf, const void *bytes, size_t len)
+{
+	memcpy(buf->code + buf->len, bytes, len);
+	buf->len += len;
+}
+
+static void emit_u8(struct jit_buf *buf, uint8_t byte)
+{
+	buf->code[buf->len++] = byte;
+}
+
+static void emit_u64(struct jit_buf *buf, uint64_t value)
+{
+	emit(buf, &value, sizeof(value));
+}
+
+/* Leave a rel32 to a label, patched once all labels are known */
+static void emit_rel32(struct jit_buf *buf, size_t target)
+{
+	buf->fixups[buf->fixup_count].pos = buf->len;
+	buf->fixups[buf->fixup_count].target = target;
+	buf->fixup_count++;
+	buf->len += 4;
+}
+
+/* Call fn(ctx, bytecode, event, instr) and branch to fail if it returns < 0 */
+static void emit_call(struct jit_buf *buf, filter_op_fn fn,
+                      const struct filter_instruction *instr, size_t fail)
+{
+	static const uint8_t args[] = {
+		0x48, 0x89, 0xdf,       /* mov rdi, rbx */
+		0x4c, 0x89, 0xe6,       /* mov rsi, r12 */
+		0x4c, 0x89, 0xea,       /* mov rdx, r13 */
+	};
+	static const uint8_t check[] = {
+		0xff, 0xd0,             /* call rax */
+		0x85, 0xc0,             /* test eax, eax */
+		0x0f, 0x88,             /* js rel32 */
+	};
+	
+	emit(buf, args, sizeof(args));
+	emit_u8(buf, 0x48);             /* mov rcx, imm64 */
+	emit_u8(buf, 0xb9);
+	emit_u64(buf, (uint64_t)(uintptr_t)instr);
+	emit_u8(buf, 0x48);             /* mov rax, imm64 */
+	emit_u8(buf, 0xb8);
+	emit_u64(buf, (uint64_t)(uintptr_t)fn);
+	emit(buf, check, sizeof(check));
+	emit_rel32(buf, fail);
+}
+
+static void emit_jmp(struct jit_buf *buf, size_t target)
+{
+	emit_u8(buf, 0xe9);             /* jmp rel32 */
+	emit_rel32(buf, target);
+}
+
+/* Branch on the result of op_test: 0 false, 1 true */
+static void emit_jump_if(struct jit_buf *buf, uint8_t value, size_t target)
+{
+	const uint8_t code[] = {
+		0x83, 0xf8, value,      /* cmp eax, value */
+		0x0f, 0x84,             /* je rel32 */
+	};
+	
+	emit(buf, code, sizeof(code));
+	emit_rel32(buf, target);
+}
+
+/* Instruction a jump at pc leads to, or SIZE_MAX if out of range */
+static size_t jump_target(const struct filter_bytecode *bytecode, size_t pc)
+{
+	const struct filter_instruction *instr = &bytecode->instructions[pc];
+	int64_t target = (int64_t)pc + instr->operand.jump.offset;
+	
+	/* The interpreter skips one more after a conditional jump */
+	if (instr->opcode != OP_JUMP)
+		target++;
+	
+	if (target < 0 || target > (int64_t)bytecode->instruction_count)
+		return SIZE_MAX;
+	return (size_t)target;
+}
+
+static bool jit_generate(struct filter_bytecode *bytecode, struct jit_buf *buf)
+{
+	static const uint8_t prologue[] = {
+		0x53,                   /* push rbx */
+		0x41, 0x54,             /* push r12 */
+		0x41, 0x55,             /* push r13, stack now 16 byte aligned */
+		0x48, 0x89, 0xfb,       /* mov rbx, rdi */
+		0x49, 0x89, 0xf4,       /* mov r12, rsi */
+		0x49, 0x89, 0xd5,       /* mov r13, rdx */
+	};
+	static const uint8_t fail[] = {
+		0x31, 0xc0,             /* xor eax, eax */
+	};
+	static const uint8_t epilogue[] = {
+		0x41, 0x5d,             /* pop r13 */
+		0x41, 0x5c,             /* pop r12 */
+		0x5b,                   /* pop rbx */
+		0xc3,                   /* ret */
+	};
+	size_t count = bytecode->instruction_count;
+	size_t end = count, fail_label = count + 1, exit_label = count + 2;
+	filter_op_fn op_return = filter_eval_op(OP_RETURN);
+	
+	emit(buf, prologue, sizeof(prologue));
+	
+	for (size_t pc = 0; pc < count; pc++) {
+		const struct filter_instruction *instr = &bytecode->instructions[pc];
+		size_t target;
+		
+		buf->labels[pc] = buf->len;
+		
+		switch (instr->opcode) {
+		case OP_NOP:
+			break;
+			
+		case OP_JUMP:
+		case OP_JUMP_IF_FALSE:
+		case OP_JUMP_IF_TRUE:
+			target = jump_target(bytecode, pc);
+			if (target == SIZE_MAX)
+				return false;
+			
+			if (instr->opcode == OP_JUMP) {
+				emit_jmp(buf, target);
+			} else {
+				emit_call(buf, filter_eval_op(instr->opcode), instr, fail_label);
+				emit_jump_if(buf, instr->opcode == OP_JUMP_IF_TRUE, target);
+			}
+			break;
+			
+		case OP_RETURN:
+			emit_call(buf, op_return, instr, fail_label);
+			emit_jmp(buf, exit_label);
+			break;
+			
+		default:
+			if (!filter_eval_op(instr->opcode))
+				return false;
+			emit_call(buf, filter_eval_op(instr->opcode), instr, fail_label);
+			break;
+		}
+	}
+	
+	/* Falling off the end returns the top of the stack */
+	buf->labels[end] = buf->len;
+	emit_call(buf, op_return, NULL, fail_label);
+	emit_jmp(buf, exit_label);
+	
+	buf->labels[fail_label] = buf->len;
+	emit(buf, fail, sizeof(fail));
+	
+	buf->labels[exit_label] = buf->len;
+	emit(buf, epilogue, sizeof(epilogue));
+	
+	for (size_t i = 0; i < buf->fixup_count; i++) {
+		int32_t rel = (int32_t)(buf->labels[buf->fixups[i].target] -
+		                        (buf->fixups[i].pos + 4));
+		memcpy(buf->code + buf->fixups[i].pos, &rel, sizeof(rel));
+	}
+	
+	return true;
+}
+
+bool filter_jit_available(void)
+{
+	return true;
+}
+
+bool filter_jit_compile(struct filter_bytecode *bytecode)
+{
+	struct filter_jit *jit, *expected = NULL;
+	struct jit_buf buf = {0};
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t size;
+	bool ok;
+	
+	if (!bytecode)
+		return false;
+	if (atomic_load(&bytecode->jit))
+		return true;
+	
+	jit = calloc(1, sizeof(*jit));
+	buf.labels = malloc((bytecode->instruction_count + 3) * sizeof(*buf.labels));
+	buf.fixups = malloc((bytecode->instruction_count * 2 + 2) * sizeof(*buf.fixups));
+	if (!jit || !buf.labels || !buf.fixups)
+		goto fail;
+	
+	size = JIT_FIXED_BYTES + bytecode->instruction_count * JIT_MAX_INSN_BYTES;
+	size = (size + page - 1) & ~(page - 1);
+	
+	buf.code = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf.code == MAP_FAILED) {
+		buf.code = NULL;
+		goto fail;
+	}
+	
+	ok = jit_generate(bytecode, &buf);
+	if (!ok || mprotect(buf.code, size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(buf.code, size);
+		goto fail;
+	}
+	
+	jit->mem = buf.code;
+	jit->size = size;
+	jit->fn = (filter_jit_fn)(uintptr_t)buf.code;
+	
+	free(buf.fixups);
+	free(buf.labels);
+	
+	/* Another thread may have compiled it meanwhile */
+	if (!atomic_compare_exchange_strong(&bytecode->jit, &expected, jit)) {
+		munmap(jit->mem, jit->size);
+		free(jit);
+	}
+	return true;
+	
+fail:
+	free(buf.fixups);
+	free(buf.labels);
+	free(jit);
+	return false;
+}
+
+#else /* !__x86_64__ || FILTER_JIT_DISABLE */
+
+bool filter_jit_available(void)
+{
+	return false;
+}
+
+bool filter_jit_compile(struct filter_bytecode *bytecode)
+{
+	return false;
+}
+
+#endif
+
+bool filter_jit_run(struct filter_bytecode *bytecode, struct nlmon_event *event,
+                    struct filter_eval_context *ctx, bool *result)
+{
+	struct filter_jit *jit = atomic_load_explicit(&bytecode->jit, memory_order_acquire);
+	
+	if (!jit)
+		return false;
+	
+	*result = jit->fn(ctx, bytecode, event);
+	return true;
+}
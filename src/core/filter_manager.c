@@ -1,29 +1,222 @@
 /* filter_manager.c - Filter management system implementation
  *
  * Manages named filters with persistence, validation, and statistics.
+ *
+ * Changes are serialized by mgr->lock and edit the filter list, then
+ * publish an immutable snapshot of it: the filters in list order, a
+ * hashed name index and, in shared mode, the DAG. Evaluation only reads
+ * the current snapshot inside a read side section and never takes the
+ * lock. A replaced snapshot, and whatever entries and bytecode only it
+ * still refers to, is freed once every section that might have seen it
+ * has ended. Sections are counted in two alternating counters, and the
+ * writer waits for both after moving readers to the other one twice.
  */
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
+#include <sched.h>
 #include "filter_manager.h"
 #include "filter_parser.h"
 #include "filter_compiler.h"
+#include "filter_cache.h"
 #include "filter_eval.h"
+#include "filter_dag.h"
+#include "filter_profile.h"
 #include "event_processor.h"
 
-/* Helper functions */
-static struct filter_entry *find_filter(struct filter_manager *mgr, const char *name)
+/* One filter as published */
+struct snapshot_item {
+	struct filter_entry *entry;      /* For names and statistics */
+	struct filter_bytecode *compiled;
+	struct filter_profile *profile;  /* NULL unless adaptive */
+	bool enabled;
+};
+
+/* Immutable view of the filters */
+struct filter_snapshot {
+	struct snapshot_item *items;     /* In list order */
+	size_t count;
+	
+	uint32_t *index;                 /* Item + 1 by name hash, 0 if free */
+	size_t index_mask;
+	
+	/* Enabled filters in shared mode, NULL to evaluate one by one */
+	struct filter_dag *dag;
+	struct filter_entry **dag_entries; /* Entry of each DAG filter id */
+	uint32_t *dag_matches;           /* Scratch for matching ids */
+};
+
+/* FNV-1a */
+static uint32_t name_hash(const char *name)
 {
+	uint32_t hash = 2166136261u;
+	
+	for (; *name; name++) {
+		hash ^= (unsigned char)*name;
+		hash *= 16777619u;
+	}
+	
+	return hash;
+}
+
+static struct snapshot_item *snapshot_find(struct filter_snapshot *snap,
+                                           const char *name)
+{
+	size_t slot;
+	uint32_t item;
+	
+	if (!snap)
+		return NULL;
+	
+	slot = name_hash(name) & snap->index_mask;
+	while ((item = snap->index[slot]) != 0) {
+		if (strcmp(snap->items[item - 1].entry->name, name) == 0)
+			return &snap->items[item - 1];
+		slot = (slot + 1) & snap->index_mask;
+	}
+	
+	return NULL;
+}
+
+static void snapshot_free(struct filter_snapshot *snap)
+{
+	if (!snap)
+		return;
+	
+	filter_dag_destroy(snap->dag);
+	free(snap->dag_entries);
+	free(snap->dag_matches);
+	free(snap->index);
+	free(snap->items);
+	free(snap);
+}
+
+/* The DAG of all enabled filters, ids follow the list order */
+static bool snapshot_build_dag(struct filter_snapshot *snap)
+{
+	size_t count = 0;
+	
+	snap->dag = filter_dag_create();
+	snap->dag_entries = malloc((snap->count + 1) * sizeof(*snap->dag_entries));
+	snap->dag_matches = malloc((snap->count + 1) * sizeof(*snap->dag_matches));
+	if (!snap->dag || !snap->dag_entries || !snap->dag_matches)
+		goto fail;
+	
+	for (size_t i = 0; i < snap->count; i++) {
+		struct filter_entry *entry = snap->items[i].entry;
+		
+		if (!snap->items[i].enabled)
+			continue;
+		
+		if (filter_dag_add(snap->dag, entry->parsed->ast) < 0)
+			goto fail;
+		snap->dag_entries[count++] = entry;
+	}
+	
+	return true;
+	
+fail:
+	filter_dag_destroy(snap->dag);
+	free(snap->dag_entries);
+	free(snap->dag_matches);
+	snap->dag = NULL;
+	snap->dag_entries = NULL;
+	snap->dag_matches = NULL;
+	return false;
+}
+
+static struct filter_snapshot *snapshot_create(struct filter_manager *mgr)
+{
+	struct filter_snapshot *snap;
 	struct filter_entry *entry;
+	size_t size = 8;
+	
+	snap = calloc(1, sizeof(*snap));
+	if (!snap)
+		return NULL;
+	
+	while (size < mgr->filter_count * 2)
+		size *= 2;
+	
+	snap->items = calloc(mgr->filter_count + 1, sizeof(*snap->items));
+	snap->index = calloc(size, sizeof(*snap->index));
+	if (!snap->items || !snap->index) {
+		snapshot_free(snap);
+		return NULL;
+	}
+	snap->index_mask = size - 1;
 	
 	for (entry = mgr->filters; entry; entry = entry->next) {
-		if (strcmp(entry->name, name) == 0)
-			return entry;
+		struct snapshot_item *item = &snap->items[snap->count];
+		size_t slot = name_hash(entry->name) & snap->index_mask;
+		
+		item->entry = entry;
+		item->compiled = entry->compiled;
+		item->profile = entry->profile;
+		item->enabled = entry->enabled;
+		
+		while (snap->index[slot] != 0)
+			slot = (slot + 1) & snap->index_mask;
+		snap->index[slot] = (uint32_t)++snap->count;
 	}
 	
-	return NULL;
+	/* Without the DAG filters are still evaluated one by one */
+	if (mgr->shared)
+		snapshot_build_dag(snap);
+	
+	return snap;
+}
+
+/* Enter a read side section, returns the counter to leave it through */
+static unsigned read_lock(struct filter_manager *mgr)
+{
+	unsigned idx = atomic_load(&mgr->reader_epoch) & 1;
+	
+	atomic_fetch_add(&mgr->readers[idx], 1);
+	return idx;
+}
+
+static void read_unlock(struct filter_manager *mgr, unsigned idx)
+{
+	atomic_fetch_sub(&mgr->readers[idx], 1);
+}
+
+/* Wait until no section can still see a replaced snapshot, lock held */
+static void synchronize(struct filter_manager *mgr)
+{
+	for (int flip = 0; flip < 2; flip++) {
+		unsigned idx = atomic_fetch_add(&mgr->reader_epoch, 1) & 1;
+		
+		while (atomic_load(&mgr->readers[idx]) != 0)
+			sched_yield();
+	}
+}
+
+/* Make the filter list visible to evaluation, lock held */
+static bool publish(struct filter_manager *mgr)
+{
+	struct filter_snapshot *snap, *old;
+	
+	snap = snapshot_create(mgr);
+	if (!snap)
+		return false;
+	
+	old = atomic_exchange(&mgr->snapshot, snap);
+	atomic_fetch_add(&mgr->version, 1);
+	synchronize(mgr);
+	snapshot_free(old);
+	return true;
+}
+
+/* Helper functions */
+static struct filter_entry *find_filter(struct filter_manager *mgr, const char *name)
+{
+	struct snapshot_item *item;
+	
+	item = snapshot_find(atomic_load(&mgr->snapshot), name);
+	return item ? item->entry : NULL;
 }
 
 static void filter_entry_free(struct filter_entry *entry)
@@ -36,6 +229,7 @@ static void filter_entry_free(struct filter_entry *entry)
 	free(entry->expression);
 	filter_expr_free(entry->parsed);
 	filter_bytecode_free(entry->compiled);
+	filter_profile_destroy(entry->profile);
 	free(entry);
 }
 
@@ -79,16 +273,13 @@ static struct filter_entry *filter_entry_create(const char *name,
 		return NULL;
 	}
 	
-	/* Compile to bytecode */
-	entry->compiled = filter_compile(entry->parsed);
+	/* Optimized bytecode, shared with equal filters */
+	entry->compiled = filter_cache_get_expr(entry->parsed);
 	if (!entry->compiled) {
 		filter_entry_free(entry);
 		return NULL;
 	}
 	
-	/* Optimize bytecode */
-	filter_bytecode_optimize(entry->compiled);
-	
 	entry->created = time(NULL);
 	entry->modified = entry->created;
 	entry->enabled = true;
@@ -96,6 +287,27 @@ static struct filter_entry *filter_entry_create(const char *name,
 	return entry;
 }
 
+static bool save_locked(struct filter_manager *mgr);
+
+static void reset_entry_stats(struct filter_entry *entry)
+{
+	atomic_store(&entry->eval_count, 0);
+	atomic_store(&entry->match_count, 0);
+	atomic_store(&entry->total_time_ns, 0);
+}
+
+/* Publish a change and auto-save it, lock held */
+static bool commit_change(struct filter_manager *mgr)
+{
+	if (!publish(mgr))
+		return false;
+	
+	if (mgr->auto_save && mgr->storage_path)
+		save_locked(mgr);
+	
+	return true;
+}
+
 /* Public API */
 struct filter_manager *filter_manager_create(const char *storage_path)
 {
@@ -120,6 +332,7 @@ struct filter_manager *filter_manager_create(const char *storage_path)
 		return NULL;
 	}
 	
+	pthread_mutex_init(&mgr->lock, NULL);
 	mgr->auto_save = true;
 	
 	return mgr;
@@ -132,6 +345,8 @@ void filter_manager_destroy(struct filter_manager *mgr)
 	if (!mgr)
 		return;
 	
+	snapshot_free(atomic_load(&mgr->snapshot));
+	
 	/* Free all filters */
 	entry = mgr->filters;
 	while (entry) {
@@ -140,6 +355,7 @@ void filter_manager_destroy(struct filter_manager *mgr)
 		entry = next;
 	}
 	
+	pthread_mutex_destroy(&mgr->lock);
 	filter_eval_context_destroy(mgr->eval_ctx);
 	free(mgr->storage_path);
 	free(mgr);
@@ -155,64 +371,87 @@ bool filter_manager_add(struct filter_manager *mgr,
 	if (!mgr || !name || !expression)
 		return false;
 	
-	/* Check if filter already exists */
-	if (find_filter(mgr, name))
-		return false;
-	
 	/* Create filter entry */
 	entry = filter_entry_create(name, expression, description);
 	if (!entry)
 		return false;
 	
+	pthread_mutex_lock(&mgr->lock);
+	
+	/* Check if filter already exists */
+	if (find_filter(mgr, name))
+		goto fail;
+	
+	/* Without a profile the filter is only never reordered */
+	if (mgr->adaptive)
+		entry->profile = filter_profile_create(entry->parsed);
+	
 	/* Add to list */
 	entry->next = mgr->filters;
 	mgr->filters = entry;
 	mgr->filter_count++;
 	
-	/* Auto-save if enabled */
-	if (mgr->auto_save && mgr->storage_path)
-		filter_manager_save(mgr);
+	if (!commit_change(mgr)) {
+		mgr->filters = entry->next;
+		mgr->filter_count--;
+		goto fail;
+	}
 	
+	pthread_mutex_unlock(&mgr->lock);
 	return true;
+	
+fail:
+	pthread_mutex_unlock(&mgr->lock);
+	filter_entry_free(entry);
+	return false;
 }
 
 bool filter_manager_remove(struct filter_manager *mgr, const char *name)
 {
-	struct filter_entry *entry, *prev;
+	struct filter_entry *entry, **link;
 	
 	if (!mgr || !name)
 		return false;
 	
-	prev = NULL;
-	for (entry = mgr->filters; entry; entry = entry->next) {
-		if (strcmp(entry->name, name) == 0) {
-			if (prev)
-				prev->next = entry->next;
-			else
-				mgr->filters = entry->next;
-			
-			filter_entry_free(entry);
-			mgr->filter_count--;
-			
-			/* Auto-save if enabled */
-			if (mgr->auto_save && mgr->storage_path)
-				filter_manager_save(mgr);
-			
-			return true;
-		}
-		prev = entry;
+	pthread_mutex_lock(&mgr->lock);
+	
+	entry = find_filter(mgr, name);
+	if (!entry) {
+		pthread_mutex_unlock(&mgr->lock);
+		return false;
 	}
 	
-	return false;
+	for (link = &mgr->filters; *link != entry; link = &(*link)->next)
+		;
+	*link = entry->next;
+	mgr->filter_count--;
+	
+	/* Evaluation may still use the entry until the new snapshot is out */
+	if (!commit_change(mgr)) {
+		*link = entry;
+		mgr->filter_count++;
+		pthread_mutex_unlock(&mgr->lock);
+		return false;
+	}
+	
+	pthread_mutex_unlock(&mgr->lock);
+	filter_entry_free(entry);
+	return true;
 }
 
 struct filter_entry *filter_manager_get(struct filter_manager *mgr,
                                         const char *name)
 {
+	struct filter_entry *entry;
+	
 	if (!mgr || !name)
 		return NULL;
 	
-	return find_filter(mgr, name);
+	pthread_mutex_lock(&mgr->lock);
+	entry = find_filter(mgr, name);
+	pthread_mutex_unlock(&mgr->lock);
+	
+	return entry;
 }
 
 bool filter_manager_update(struct filter_manager *mgr,
@@ -220,16 +459,14 @@ bool filter_manager_update(struct filter_manager *mgr,
                            const char *expression)
 {
 	struct filter_entry *entry;
-	struct filter_expr *parsed;
-	struct filter_bytecode *compiled;
+	struct filter_expr *parsed, *old_parsed;
+	struct filter_bytecode *compiled, *old_compiled;
+	struct filter_profile *profile = NULL, *old_profile;
+	char *copy, *old_expression;
 	
 	if (!mgr || !name || !expression)
 		return false;
 	
-	entry = find_filter(mgr, name);
-	if (!entry)
-		return false;
-	
 	/* Parse and compile new expression */
 	parsed = filter_parse(expression);
 	if (!parsed || !parsed->valid) {
@@ -237,99 +474,316 @@ bool filter_manager_update(struct filter_manager *mgr,
 		return false;
 	}
 	
-	compiled = filter_compile(parsed);
-	if (!compiled) {
+	compiled = filter_cache_get_expr(parsed);
+	copy = strdup(expression);
+	if (!compiled || !copy) {
+		filter_bytecode_free(compiled);
 		filter_expr_free(parsed);
+		free(copy);
 		return false;
 	}
 	
-	filter_bytecode_optimize(compiled);
+	pthread_mutex_lock(&mgr->lock);
 	
-	/* Update entry */
-	free(entry->expression);
-	filter_expr_free(entry->parsed);
-	filter_bytecode_free(entry->compiled);
+	entry = find_filter(mgr, name);
+	if (!entry)
+		goto fail;
 	
-	entry->expression = strdup(expression);
+	if (mgr->adaptive)
+		profile = filter_profile_create(parsed);
+	
+	/* Update entry, the old filter stays valid until published */
+	old_expression = entry->expression;
+	old_parsed = entry->parsed;
+	old_compiled = entry->compiled;
+	old_profile = entry->profile;
+	
+	entry->expression = copy;
 	entry->parsed = parsed;
 	entry->compiled = compiled;
+	entry->profile = profile;
+	
+	if (!commit_change(mgr)) {
+		entry->expression = old_expression;
+		entry->parsed = old_parsed;
+		entry->compiled = old_compiled;
+		entry->profile = old_profile;
+		goto fail;
+	}
+	
 	entry->modified = time(NULL);
 	
 	/* Reset statistics */
-	entry->eval_count = 0;
-	entry->match_count = 0;
-	entry->total_time_ns = 0;
+	reset_entry_stats(entry);
 	
-	/* Auto-save if enabled */
-	if (mgr->auto_save && mgr->storage_path)
-		filter_manager_save(mgr);
+	pthread_mutex_unlock(&mgr->lock);
 	
+	free(old_expression);
+	filter_profile_destroy(old_profile);
+	filter_expr_free(old_parsed);
+	filter_bytecode_free(old_compiled);
 	return true;
+	
+fail:
+	pthread_mutex_unlock(&mgr->lock);
+	filter_profile_destroy(profile);
+	filter_bytecode_free(compiled);
+	filter_expr_free(parsed);
+	free(copy);
+	return false;
 }
 
-bool filter_manager_enable(struct filter_manager *mgr, const char *name)
+static bool set_enabled(struct filter_manager *mgr, const char *name, bool enabled)
 {
 	struct filter_entry *entry;
+	bool was_enabled;
+	bool ok = false;
 	
 	if (!mgr || !name)
 		return false;
 	
-	entry = find_filter(mgr, name);
-	if (!entry)
-		return false;
-	
-	entry->enabled = true;
+	pthread_mutex_lock(&mgr->lock);
 	
-	if (mgr->auto_save && mgr->storage_path)
-		filter_manager_save(mgr);
+	entry = find_filter(mgr, name);
+	if (entry) {
+		was_enabled = entry->enabled;
+		entry->enabled = enabled;
+		
+		ok = commit_change(mgr);
+		if (!ok)
+			entry->enabled = was_enabled;
+	}
 	
-	return true;
+	pthread_mutex_unlock(&mgr->lock);
+	return ok;
+}
+
+bool filter_manager_enable(struct filter_manager *mgr, const char *name)
+{
+	return set_enabled(mgr, name, true);
 }
 
 bool filter_manager_disable(struct filter_manager *mgr, const char *name)
 {
-	struct filter_entry *entry;
-	
-	if (!mgr || !name)
-		return false;
+	return set_enabled(mgr, name, false);
+}
+
+static bool eval_item(struct filter_manager *mgr, struct snapshot_item *item,
+                      struct nlmon_event *event)
+{
+	struct filter_entry *entry = item->entry;
+	uint64_t elapsed_ns, evals;
+	bool result;
 	
-	entry = find_filter(mgr, name);
-	if (!entry)
-		return false;
+	result = filter_eval_with_profiling(item->compiled, event,
+	                                    mgr->eval_ctx, &elapsed_ns);
 	
-	entry->enabled = false;
+	/* Update statistics */
+	evals = ++entry->eval_count;
+	entry->total_time_ns += elapsed_ns;
+	if (result)
+		entry->match_count++;
 	
-	if (mgr->auto_save && mgr->storage_path)
-		filter_manager_save(mgr);
+	if (item->profile && evals % FILTER_MANAGER_SAMPLE_INTERVAL == 0)
+		filter_profile_sample(item->profile, event, mgr->eval_ctx);
 	
-	return true;
+	return result;
 }
 
 bool filter_manager_eval(struct filter_manager *mgr,
                          const char *name,
                          struct nlmon_event *event)
 {
-	struct filter_entry *entry;
-	uint64_t elapsed_ns;
-	bool result;
+	struct snapshot_item *item;
+	bool result = false;
+	unsigned idx;
 	
 	if (!mgr || !name || !event)
 		return false;
 	
-	entry = find_filter(mgr, name);
-	if (!entry || !entry->enabled)
-		return false;
+	idx = read_lock(mgr);
 	
-	result = filter_eval_with_profiling(entry->compiled, event,
-	                                    mgr->eval_ctx, &elapsed_ns);
+	item = snapshot_find(atomic_load(&mgr->snapshot), name);
+	if (item && item->enabled)
+		result = eval_item(mgr, item, event);
 	
-	/* Update statistics */
-	entry->eval_count++;
-	entry->total_time_ns += elapsed_ns;
-	if (result)
+	read_unlock(mgr, idx);
+	return result;
+}
+
+void filter_manager_set_shared(struct filter_manager *mgr, bool shared)
+{
+	if (!mgr)
+		return;
+	
+	pthread_mutex_lock(&mgr->lock);
+	
+	mgr->shared = shared;
+	if (!publish(mgr))
+		mgr->shared = !shared;
+	
+	pthread_mutex_unlock(&mgr->lock);
+}
+
+void filter_manager_set_adaptive(struct filter_manager *mgr, bool adaptive)
+{
+	struct filter_entry *entry;
+	struct filter_profile **old = NULL;
+	size_t count = 0;
+	
+	if (!mgr)
+		return;
+	
+	pthread_mutex_lock(&mgr->lock);
+	
+	if (mgr->adaptive == adaptive) {
+		pthread_mutex_unlock(&mgr->lock);
+		return;
+	}
+	
+	/* Profiles being dropped stay in use until the snapshot is replaced */
+	if (!adaptive) {
+		old = calloc(mgr->filter_count + 1, sizeof(*old));
+		if (!old) {
+			pthread_mutex_unlock(&mgr->lock);
+			return;
+		}
+	}
+	
+	for (entry = mgr->filters; entry; entry = entry->next, count++) {
+		if (adaptive) {
+			entry->profile = filter_profile_create(entry->parsed);
+		} else {
+			old[count] = entry->profile;
+			entry->profile = NULL;
+		}
+	}
+	
+	mgr->adaptive = adaptive;
+	if (!publish(mgr)) {
+		count = 0;
+		for (entry = mgr->filters; entry; entry = entry->next, count++) {
+			if (adaptive) {
+				filter_profile_destroy(entry->profile);
+				entry->profile = NULL;
+			} else {
+				entry->profile = old[count];
+				old[count] = NULL;
+			}
+		}
+		mgr->adaptive = !adaptive;
+	}
+	
+	pthread_mutex_unlock(&mgr->lock);
+	
+	for (size_t i = 0; old && i < count; i++)
+		filter_profile_destroy(old[i]);
+	free(old);
+}
+
+/* Filter recompiled by filter_manager_reorder() */
+struct reorder_change {
+	struct filter_entry *entry;
+	struct filter_bytecode *compiled;
+	struct filter_profile *profile;
+};
+
+size_t filter_manager_reorder(struct filter_manager *mgr)
+{
+	struct reorder_change *changes;
+	struct filter_entry *entry;
+	struct filter_bytecode *compiled;
+	struct filter_profile *profile;
+	size_t count = 0;
+	
+	if (!mgr)
+		return 0;
+	
+	pthread_mutex_lock(&mgr->lock);
+	
+	changes = calloc(mgr->filter_count + 1, sizeof(*changes));
+	if (!changes) {
+		pthread_mutex_unlock(&mgr->lock);
+		return 0;
+	}
+	
+	/* The AST is only read under the lock, evaluation uses bytecode */
+	for (entry = mgr->filters; entry; entry = entry->next) {
+		if (!filter_profile_reorder(entry->profile))
+			continue;
+		
+		/* Not through the cache, which takes any order of the chain for the first */
+		compiled = filter_compile(entry->parsed);
+		profile = filter_profile_create(entry->parsed);
+		if (!compiled || !profile) {
+			filter_profile_destroy(profile);
+			filter_bytecode_free(compiled);
+			filter_profile_restore(entry->profile);
+			continue;
+		}
+		filter_bytecode_optimize(compiled);
+		
+		changes[count].entry = entry;
+		changes[count].compiled = entry->compiled;
+		changes[count].profile = entry->profile;
+		count++;
+		
+		entry->compiled = compiled;
+		entry->profile = profile;
+	}
+	
+	if (count > 0 && !publish(mgr)) {
+		for (size_t i = 0; i < count; i++) {
+			entry = changes[i].entry;
+			filter_profile_destroy(entry->profile);
+			filter_bytecode_free(entry->compiled);
+			
+			entry->compiled = changes[i].compiled;
+			entry->profile = changes[i].profile;
+			filter_profile_restore(entry->profile);
+			
+			changes[i].compiled = NULL;
+			changes[i].profile = NULL;
+		}
+		count = 0;
+	}
+	
+	pthread_mutex_unlock(&mgr->lock);
+	
+	for (size_t i = 0; i < count; i++) {
+		filter_profile_destroy(changes[i].profile);
+		filter_bytecode_free(changes[i].compiled);
+	}
+	free(changes);
+	
+	return count;
+}
+
+static size_t eval_all_shared(struct filter_snapshot *snap,
+                              struct filter_manager *mgr,
+                              struct nlmon_event *event,
+                              const char **matches,
+                              size_t max_matches)
+{
+	struct filter_dag_stats stats;
+	struct filter_entry *entry;
+	size_t count;
+	
+	filter_dag_get_stats(snap->dag, &stats);
+	for (size_t i = 0; i < stats.filters; i++)
+		snap->dag_entries[i]->eval_count++;
+	
+	count = filter_dag_eval(snap->dag, event, mgr->eval_ctx,
+	                        snap->dag_matches, stats.filters);
+	
+	for (size_t i = 0; i < count; i++) {
+		entry = snap->dag_entries[snap->dag_matches[i]];
 		entry->match_count++;
+		if (matches && i < max_matches)
+			matches[i] = entry->name;
+	}
 	
-	return result;
+	return count;
 }
 
 size_t filter_manager_eval_all(struct filter_manager *mgr,
@@ -337,23 +791,36 @@ size_t filter_manager_eval_all(struct filter_manager *mgr,
                                const char **matches,
                                size_t max_matches)
 {
-	struct filter_entry *entry;
+	struct filter_snapshot *snap;
 	size_t match_count = 0;
+	unsigned idx;
 	
 	if (!mgr || !event)
 		return 0;
 	
-	for (entry = mgr->filters; entry; entry = entry->next) {
-		if (!entry->enabled)
+	idx = read_lock(mgr);
+	
+	snap = atomic_load(&mgr->snapshot);
+	if (snap && snap->dag) {
+		match_count = eval_all_shared(snap, mgr, event, matches, max_matches);
+		read_unlock(mgr, idx);
+		return match_count;
+	}
+	
+	for (size_t i = 0; snap && i < snap->count; i++) {
+		struct snapshot_item *item = &snap->items[i];
+		
+		if (!item->enabled)
 			continue;
 		
-		if (filter_manager_eval(mgr, entry->name, event)) {
+		if (eval_item(mgr, item, event)) {
 			if (matches && match_count < max_matches)
-				matches[match_count] = entry->name;
+				matches[match_count] = item->entry->name;
 			match_count++;
 		}
 	}
 	
+	read_unlock(mgr, idx);
 	return match_count;
 }
 
@@ -367,23 +834,28 @@ size_t filter_manager_list(struct filter_manager *mgr,
 	if (!mgr)
 		return 0;
 	
+	pthread_mutex_lock(&mgr->lock);
+	
 	for (entry = mgr->filters; entry; entry = entry->next) {
 		if (names && count < max_count)
 			names[count] = entry->name;
 		count++;
 	}
 	
+	pthread_mutex_unlock(&mgr->lock);
 	return count;
 }
 
-bool filter_manager_save(struct filter_manager *mgr)
+uint64_t filter_manager_get_version(struct filter_manager *mgr)
+{
+	return mgr ? atomic_load(&mgr->version) : 0;
+}
+
+static bool save_locked(struct filter_manager *mgr)
 {
 	FILE *fp;
 	struct filter_entry *entry;
 	
-	if (!mgr || !mgr->storage_path)
-		return false;
-	
 	fp = fopen(mgr->storage_path, "w");
 	if (!fp)
 		return false;
@@ -405,6 +877,20 @@ bool filter_manager_save(struct filter_manager *mgr)
 	return true;
 }
 
+bool filter_manager_save(struct filter_manager *mgr)
+{
+	bool ok;
+	
+	if (!mgr || !mgr->storage_path)
+		return false;
+	
+	pthread_mutex_lock(&mgr->lock);
+	ok = save_locked(mgr);
+	pthread_mutex_unlock(&mgr->lock);
+	
+	return ok;
+}
+
 int filter_manager_load(struct filter_manager *mgr)
 {
 	FILE *fp;
@@ -482,47 +968,55 @@ bool filter_manager_stats(struct filter_manager *mgr,
                          uint64_t *match_count,
                          uint64_t *avg_time_ns)
 {
-	struct filter_entry *entry;
+	struct snapshot_item *item;
+	uint64_t evals;
+	unsigned idx;
 	
 	if (!mgr || !name)
 		return false;
 	
-	entry = find_filter(mgr, name);
-	if (!entry)
+	idx = read_lock(mgr);
+	
+	item = snapshot_find(atomic_load(&mgr->snapshot), name);
+	if (!item) {
+		read_unlock(mgr, idx);
 		return false;
+	}
 	
+	evals = item->entry->eval_count;
 	if (eval_count)
-		*eval_count = entry->eval_count;
+		*eval_count = evals;
 	if (match_count)
-		*match_count = entry->match_count;
+		*match_count = item->entry->match_count;
 	if (avg_time_ns)
-		*avg_time_ns = entry->eval_count > 0 ?
-		               entry->total_time_ns / entry->eval_count : 0;
+		*avg_time_ns = evals > 0 ? item->entry->total_time_ns / evals : 0;
 	
+	read_unlock(mgr, idx);
 	return true;
 }
 
 void filter_manager_reset_stats(struct filter_manager *mgr, const char *name)
 {
-	struct filter_entry *entry;
+	struct filter_snapshot *snap;
+	struct snapshot_item *item;
+	unsigned idx;
 	
 	if (!mgr)
 		return;
 	
+	idx = read_lock(mgr);
+	snap = atomic_load(&mgr->snapshot);
+	
 	if (name) {
 		/* Reset specific filter */
-		entry = find_filter(mgr, name);
-		if (entry) {
-			entry->eval_count = 0;
-			entry->match_count = 0;
-			entry->total_time_ns = 0;
-		}
+		item = snapshot_find(snap, name);
+		if (item)
+			reset_entry_stats(item->entry);
 	} else {
 		/* Reset all filters */
-		for (entry = mgr->filters; entry; entry = entry->next) {
-			entry->eval_count = 0;
-			entry->match_count = 0;
-			entry->total_time_ns = 0;
-		}
+		for (size_t i = 0; snap && i < snap->count; i++)
+			reset_entry_stats(snap->items[i].entry);
 	}
+	
+	read_unlock(mgr, idx);
 }
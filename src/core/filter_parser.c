@@ -7,8 +7,12 @@
  *   and_expr -> not_expr ( AND not_expr )*
  *   not_expr -> NOT not_expr | cmp_expr
  *   cmp_expr -> primary ( (==|!=|<|>|<=|>=|=~|!~|IN) primary )?
- *   primary  -> FIELD | STRING | NUMBER | '(' expr ')' | '[' list ']'
+ *   primary  -> FIELD | call | STRING | NUMBER | '(' expr ')' | '[' list ']'
+ *   call     -> NAME '(' ( STRING | NUMBER )? ')'
  *   list     -> primary ( ',' primary )*
+ *
+ * A call's name must be a registered predicate, see filter_predicate.h.
+ * Calls are boolean, they are neither compared nor listed.
  */
 
 #include <stdlib.h>
@@ -16,6 +20,7 @@
 #include <ctype.h>
 #include <stdio.h>
 #include "filter_parser.h"
+#include "filter_predicate.h"
 
 /* Token types */
 enum token_type {
@@ -569,6 +574,16 @@ static struct filter_node *create_number_node(int64_t value)
 	return node;
 }
 
+static struct filter_node *create_call_node(int predicate, struct filter_node *arg)
+{
+	struct filter_node *node = create_node(FILTER_NODE_CALL);
+	if (node) {
+		node->data.call.predicate = predicate;
+		node->data.call.arg = arg;
+	}
+	return node;
+}
+
 /* Parser functions */
 static bool expect_token(struct parser *p, enum token_type type)
 {
@@ -579,15 +594,80 @@ static bool expect_token(struct parser *p, enum token_type type)
 	return true;
 }
 
+/* Call of the predicate name, the current token is its '(' */
+static struct filter_node *parse_call(struct parser *p, const char *name)
+{
+	enum filter_predicate_arg arg_type;
+	struct filter_node *arg = NULL, *node;
+	int predicate;
+	
+	predicate = filter_predicate_lookup(name, &arg_type);
+	if (predicate < 0) {
+		set_error(p, "Unknown predicate");
+		return NULL;
+	}
+	lexer_next_token(&p->lexer);
+	
+	switch (arg_type) {
+	case FILTER_PREDICATE_ARG_STRING:
+		if (p->lexer.current.type != TOKEN_STRING) {
+			set_error(p, "Predicate takes a string argument");
+			return NULL;
+		}
+		arg = create_string_node(p->lexer.current.value);
+		lexer_next_token(&p->lexer);
+		break;
+	case FILTER_PREDICATE_ARG_NUMBER:
+		if (p->lexer.current.type != TOKEN_NUMBER) {
+			set_error(p, "Predicate takes a number argument");
+			return NULL;
+		}
+		arg = create_number_node(atoll(p->lexer.current.value));
+		lexer_next_token(&p->lexer);
+		break;
+	case FILTER_PREDICATE_ARG_NONE:
+		break;
+	}
+	
+	if (arg_type != FILTER_PREDICATE_ARG_NONE && !arg) {
+		set_error(p, "Out of memory");
+		return NULL;
+	}
+	
+	if (p->lexer.current.type != TOKEN_RPAREN) {
+		set_error(p, arg_type == FILTER_PREDICATE_ARG_NONE ?
+		          "Predicate takes no argument" : "Expected ')'");
+		filter_node_free(arg);
+		return NULL;
+	}
+	lexer_next_token(&p->lexer);
+	
+	node = create_call_node(predicate, arg);
+	if (!node) {
+		filter_node_free(arg);
+		set_error(p, "Out of memory");
+	}
+	return node;
+}
+
 static struct filter_node *parse_primary(struct parser *p)
 {
 	struct filter_node *node = NULL;
 	
 	switch (p->lexer.current.type) {
-	case TOKEN_FIELD:
-		node = create_field_node(parse_field_name(p->lexer.current.value));
+	case TOKEN_FIELD: {
+		/* Keep the name past the next token */
+		char *name = p->lexer.current.value;
+		
+		p->lexer.current.value = NULL;
 		lexer_next_token(&p->lexer);
+		if (p->lexer.current.type == TOKEN_LPAREN)
+			node = parse_call(p, name);
+		else
+			node = create_field_node(parse_field_name(name));
+		free(name);
 		break;
+	}
 		
 	case TOKEN_STRING:
 		node = create_string_node(p->lexer.current.value);
@@ -640,6 +720,11 @@ static struct filter_node *parse_primary(struct parser *p)
 			}
 			
 			items[count] = parse_primary(p);
+			if (items[count] && items[count]->type == FILTER_NODE_CALL) {
+				set_error(p, "Predicate calls cannot be listed");
+				filter_node_free(items[count]);
+				items[count] = NULL;
+			}
 			if (!items[count]) {
 				for (size_t i = 0; i < count; i++)
 					filter_node_free(items[i]);
@@ -730,6 +815,13 @@ static struct filter_node *parse_cmp_expr(struct parser *p)
 		return NULL;
 	}
 	
+	if (left->type == FILTER_NODE_CALL || right->type == FILTER_NODE_CALL) {
+		set_error(p, "Predicate calls cannot be compared");
+		filter_node_free(left);
+		filter_node_free(right);
+		return NULL;
+	}
+	
 	return create_binary_node(op_type, left, right);
 }
 
@@ -883,6 +975,10 @@ void filter_node_free(struct filter_node *node)
 		free(node->data.list.items);
 		break;
 		
+	case FILTER_NODE_CALL:
+		filter_node_free(node->data.call.arg);
+		break;
+		
 	case FILTER_NODE_FIELD:
 	case FILTER_NODE_NUMBER:
 		/* No dynamic memory to free */
@@ -892,6 +988,29 @@ void filter_node_free(struct filter_node *node)
 	free(node);
 }
 
+bool filter_node_fallible(const struct filter_node *node)
+{
+	switch (node->type) {
+	case FILTER_NODE_FIELD:
+		return node->data.field.field >= FILTER_FIELD_NL_LINK_IFNAME;
+	case FILTER_NODE_NOT:
+		return filter_node_fallible(node->data.unary.operand);
+	case FILTER_NODE_STRING:
+	case FILTER_NODE_NUMBER:
+	case FILTER_NODE_CALL:
+		return false;
+	case FILTER_NODE_LIST:
+		for (size_t i = 0; i < node->data.list.count; i++) {
+			if (filter_node_fallible(node->data.list.items[i]))
+				return true;
+		}
+		return false;
+	default:
+		return filter_node_fallible(node->data.binary.left) ||
+		       filter_node_fallible(node->data.binary.right);
+	}
+}
+
 void filter_expr_free(struct filter_expr *expr)
 {
 	if (!expr)
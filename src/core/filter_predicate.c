@@ -0,0 +1,261 @@
+/* filter_predicate.c - Native predicates callable from filter expressions
+ *
+ * Slots are handed out once per name and never reused for another, so a
+ * compiled call keeps pointing at its name. Registration and lookup take
+ * a lock; calls only load the slot's function and count themselves in,
+ * which lets unregistration wait until no call still uses the function.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sched.h>
+#include <strings.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "filter_predicate.h"
+#include "filter_parser.h"
+
+struct predicate_slot {
+	char name[FILTER_PREDICATE_NAME_MAX];
+	_Atomic(filter_predicate_fn) fn;      /* NULL while unregistered */
+	_Atomic unsigned int calls;           /* Calls in progress */
+	enum filter_predicate_arg arg;
+	uint32_t cost_ns;
+	void *data;
+	const void *owner;
+};
+
+static struct predicate_slot slots[FILTER_PREDICATE_MAX];
+static _Atomic size_t slot_count;
+static pthread_mutex_t predicate_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool valid_name(const char *name)
+{
+	static const char *const keywords[] = { "AND", "OR", "NOT", "IN" };
+	size_t len = strlen(name);
+	
+	if (len == 0 || len >= FILTER_PREDICATE_NAME_MAX || isdigit((unsigned char)name[0]))
+		return false;
+	for (size_t i = 0; i < len; i++) {
+		if (!isalnum((unsigned char)name[i]) && name[i] != '_')
+			return false;
+	}
+	for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+		if (strcasecmp(name, keywords[i]) == 0)
+			return false;
+	}
+	
+	return true;
+}
+
+/* Slot of a name, registered or not, with predicate_lock held */
+static int find_slot(const char *name)
+{
+	size_t count = atomic_load(&slot_count);
+	
+	for (size_t i = 0; i < count; i++) {
+		if (strcmp(slots[i].name, name) == 0)
+			return (int)i;
+	}
+	
+	return -1;
+}
+
+/* Take the function away and wait for the calls still using it */
+static void slot_clear(struct predicate_slot *slot)
+{
+	atomic_store(&slot->fn, NULL);
+	while (atomic_load(&slot->calls))
+		sched_yield();
+	slot->data = NULL;
+	slot->owner = NULL;
+}
+
+int filter_predicate_register(const char *name, filter_predicate_fn fn,
+                              enum filter_predicate_arg arg, uint32_t cost_ns,
+                              void *data, const void *owner)
+{
+	struct predicate_slot *slot;
+	int id;
+	
+	if (!name || !fn || !valid_name(name) || arg < FILTER_PREDICATE_ARG_NONE ||
+	    arg > FILTER_PREDICATE_ARG_NUMBER)
+		return -EINVAL;
+	
+	pthread_mutex_lock(&predicate_lock);
+	
+	id = find_slot(name);
+	if (id >= 0 && atomic_load(&slots[id].fn)) {
+		pthread_mutex_unlock(&predicate_lock);
+		return -EEXIST;
+	}
+	
+	if (id < 0) {
+		if (atomic_load(&slot_count) == FILTER_PREDICATE_MAX) {
+			pthread_mutex_unlock(&predicate_lock);
+			return -ENOSPC;
+		}
+		id = (int)atomic_load(&slot_count);
+		strcpy(slots[id].name, name);
+		atomic_store(&slot_count, (size_t)id + 1);
+	}
+	
+	slot = &slots[id];
+	slot->arg = arg;
+	slot->cost_ns = cost_ns;
+	slot->data = data;
+	slot->owner = owner;
+	atomic_store(&slot->fn, fn);
+	
+	pthread_mutex_unlock(&predicate_lock);
+	return id;
+}
+
+int filter_predicate_replace(const char *name, filter_predicate_fn fn,
+                             enum filter_predicate_arg arg, uint32_t cost_ns,
+                             void *data, const void *old_owner, const void *owner)
+{
+	struct predicate_slot *slot;
+	int id;
+	
+	if (!name || !fn)
+		return -EINVAL;
+	
+	pthread_mutex_lock(&predicate_lock);
+	
+	id = find_slot(name);
+	if (id < 0 || !atomic_load(&slots[id].fn) || slots[id].owner != old_owner) {
+		pthread_mutex_unlock(&predicate_lock);
+		return -ENOENT;
+	}
+	
+	slot = &slots[id];
+	if (slot->arg != arg) {
+		pthread_mutex_unlock(&predicate_lock);
+		return -EINVAL;
+	}
+	
+	/* fn and data change together only while no call can load them */
+	slot_clear(slot);
+	slot->cost_ns = cost_ns;
+	slot->data = data;
+	slot->owner = owner;
+	atomic_store(&slot->fn, fn);
+	
+	pthread_mutex_unlock(&predicate_lock);
+	return id;
+}
+
+int filter_predicate_unregister(const char *name)
+{
+	int id;
+	
+	if (!name)
+		return -ENOENT;
+	
+	pthread_mutex_lock(&predicate_lock);
+	id = find_slot(name);
+	if (id < 0 || !atomic_load(&slots[id].fn)) {
+		pthread_mutex_unlock(&predicate_lock);
+		return -ENOENT;
+	}
+	slot_clear(&slots[id]);
+	pthread_mutex_unlock(&predicate_lock);
+	
+	return 0;
+}
+
+int filter_predicate_unregister_owner(const void *owner)
+{
+	size_t count;
+	int removed = 0;
+	
+	if (!owner)
+		return 0;
+	
+	pthread_mutex_lock(&predicate_lock);
+	count = atomic_load(&slot_count);
+	for (size_t i = 0; i < count; i++) {
+		if (slots[i].owner == owner && atomic_load(&slots[i].fn)) {
+			slot_clear(&slots[i]);
+			removed++;
+		}
+	}
+	pthread_mutex_unlock(&predicate_lock);
+	
+	return removed;
+}
+
+int filter_predicate_lookup(const char *name, enum filter_predicate_arg *arg)
+{
+	int id;
+	
+	if (!name)
+		return -1;
+	
+	pthread_mutex_lock(&predicate_lock);
+	id = find_slot(name);
+	if (id >= 0 && !atomic_load(&slots[id].fn))
+		id = -1;
+	if (id >= 0 && arg)
+		*arg = slots[id].arg;
+	pthread_mutex_unlock(&predicate_lock);
+	
+	return id;
+}
+
+const char *filter_predicate_name(int id)
+{
+	if (id < 0 || (size_t)id >= atomic_load(&slot_count))
+		return NULL;
+	return slots[id].name;
+}
+
+uint64_t filter_predicate_node_cost(const struct filter_node *node)
+{
+	uint64_t cost = 0;
+	
+	if (!node)
+		return 0;
+	
+	switch (node->type) {
+	case FILTER_NODE_CALL:
+		pthread_mutex_lock(&predicate_lock);
+		cost = slots[node->data.call.predicate].cost_ns;
+		pthread_mutex_unlock(&predicate_lock);
+		return cost + 1;
+	case FILTER_NODE_NOT:
+		return filter_predicate_node_cost(node->data.unary.operand);
+	case FILTER_NODE_FIELD:
+	case FILTER_NODE_STRING:
+	case FILTER_NODE_NUMBER:
+	case FILTER_NODE_LIST:
+		return 0;
+	default:
+		return filter_predicate_node_cost(node->data.binary.left) +
+		       filter_predicate_node_cost(node->data.binary.right);
+	}
+}
+
+bool filter_predicate_call(int id, const struct nlmon_event *event,
+                           const char *string, int64_t number)
+{
+	struct predicate_slot *slot;
+	filter_predicate_fn fn;
+	bool matches = false;
+	
+	if (id < 0 || id >= FILTER_PREDICATE_MAX)
+		return false;
+	
+	/* Counted in before loading fn, see slot_clear() */
+	slot = &slots[id];
+	atomic_fetch_add(&slot->calls, 1);
+	fn = atomic_load(&slot->fn);
+	if (fn)
+		matches = fn(event, string, number, slot->data) != 0;
+	atomic_fetch_sub(&slot->calls, 1);
+	
+	return matches;
+}
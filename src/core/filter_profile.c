@@ -0,0 +1,356 @@
+/* filter_profile.c - Cost based ordering of AND/OR chains
+ *
+ * Nested operators of one kind form a chain, "a AND (b AND c)" has the
+ * operands a, b and c. Each operand is compiled on its own for sampling.
+ * Reordering relinks the chain's operator nodes into a left deep tree
+ * over the operands in their new order, so the parent's pointer to the
+ * chain and every node the AST owns stay the same.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "filter_profile.h"
+#include "filter_parser.h"
+#include "filter_compiler.h"
+#include "filter_eval.h"
+#include "filter_predicate.h"
+
+/* One operand of a chain */
+struct profile_operand {
+	struct filter_node *node;
+	struct filter_bytecode *bytecode;
+	bool fallible;                  /* Reads a field events may not carry */
+	uint64_t declared_ns;           /* Declared cost of its predicate calls */
+	
+	_Atomic uint64_t evals;
+	_Atomic uint64_t trues;
+	_Atomic uint64_t time_ns;
+};
+
+struct profile_chain {
+	enum filter_node_type type;     /* FILTER_NODE_AND or FILTER_NODE_OR */
+	struct filter_node **inner;     /* Operator nodes, the root first */
+	struct profile_operand *operands; /* In the order at creation */
+	size_t *order;                  /* Operands as currently linked */
+	size_t count;
+	
+	/* Scratch for filter_profile_reorder() */
+	size_t *next;
+	double *rank;
+};
+
+struct filter_profile {
+	struct profile_chain *chains;
+	size_t chain_count;
+	size_t chain_capacity;
+	
+	_Atomic uint64_t samples;
+};
+
+static struct filter_bytecode *compile_operand(struct filter_node *node)
+{
+	struct filter_bytecode *bytecode;
+	struct filter_expr expr;
+	
+	/* The compiler only reads the AST */
+	memset(&expr, 0, sizeof(expr));
+	expr.ast = node;
+	expr.valid = true;
+	
+	bytecode = filter_compile(&expr);
+	if (bytecode)
+		filter_bytecode_optimize(bytecode);
+	return bytecode;
+}
+
+static size_t chain_size(const struct filter_node *node, enum filter_node_type type)
+{
+	if (node->type != type)
+		return 1;
+	return chain_size(node->data.binary.left, type) +
+	       chain_size(node->data.binary.right, type);
+}
+
+static void chain_flatten(struct profile_chain *chain, struct filter_node *node,
+                          size_t *inner, size_t *operands)
+{
+	if (node->type != chain->type) {
+		chain->operands[(*operands)++].node = node;
+		return;
+	}
+	
+	chain->inner[(*inner)++] = node;
+	chain_flatten(chain, node->data.binary.left, inner, operands);
+	chain_flatten(chain, node->data.binary.right, inner, operands);
+}
+
+static void chain_free(struct profile_chain *chain)
+{
+	for (size_t i = 0; chain->operands && i < chain->count; i++)
+		filter_bytecode_free(chain->operands[i].bytecode);
+	free(chain->operands);
+	free(chain->inner);
+	free(chain->order);
+	free(chain->next);
+	free(chain->rank);
+}
+
+static bool profile_collect(struct filter_profile *profile, struct filter_node *node);
+
+/* Add the chain rooted at node, then the chains inside its operands */
+static bool profile_add_chain(struct filter_profile *profile, struct filter_node *node)
+{
+	struct profile_chain chain = { .type = node->type };
+	size_t inner = 0, operands = 0;
+	
+	chain.count = chain_size(node, node->type);
+	chain.inner = calloc(chain.count - 1, sizeof(*chain.inner));
+	chain.operands = calloc(chain.count, sizeof(*chain.operands));
+	chain.order = calloc(chain.count, sizeof(*chain.order));
+	chain.next = calloc(chain.count, sizeof(*chain.next));
+	chain.rank = calloc(chain.count, sizeof(*chain.rank));
+	if (!chain.inner || !chain.operands || !chain.order || !chain.next || !chain.rank)
+		goto fail;
+	
+	chain_flatten(&chain, node, &inner, &operands);
+	
+	for (size_t i = 0; i < chain.count; i++) {
+		struct profile_operand *op = &chain.operands[i];
+		
+		op->bytecode = compile_operand(op->node);
+		if (!op->bytecode)
+			goto fail;
+		op->fallible = filter_node_fallible(op->node);
+		op->declared_ns = filter_predicate_node_cost(op->node);
+		chain.order[i] = i;
+	}
+	
+	if (profile->chain_count == profile->chain_capacity) {
+		size_t cap = profile->chain_capacity ? profile->chain_capacity * 2 : 4;
+		struct profile_chain *chains;
+		
+		chains = realloc(profile->chains, cap * sizeof(*chains));
+		if (!chains)
+			goto fail;
+		profile->chains = chains;
+		profile->chain_capacity = cap;
+	}
+	profile->chains[profile->chain_count++] = chain;
+	
+	for (size_t i = 0; i < chain.count; i++) {
+		if (!profile_collect(profile, chain.operands[i].node))
+			return false;
+	}
+	
+	return true;
+	
+fail:
+	chain_free(&chain);
+	return false;
+}
+
+static bool profile_collect(struct filter_profile *profile, struct filter_node *node)
+{
+	switch (node->type) {
+	case FILTER_NODE_AND:
+	case FILTER_NODE_OR:
+		return profile_add_chain(profile, node);
+	case FILTER_NODE_NOT:
+		return profile_collect(profile, node->data.unary.operand);
+	default:
+		return true;
+	}
+}
+
+struct filter_profile *filter_profile_create(struct filter_expr *expr)
+{
+	struct filter_profile *profile;
+	
+	if (!expr || !expr->ast)
+		return NULL;
+	
+	profile = calloc(1, sizeof(*profile));
+	if (!profile)
+		return NULL;
+	
+	if (!profile_collect(profile, expr->ast)) {
+		filter_profile_destroy(profile);
+		return NULL;
+	}
+	
+	return profile;
+}
+
+void filter_profile_destroy(struct filter_profile *profile)
+{
+	if (!profile)
+		return;
+	
+	for (size_t i = 0; i < profile->chain_count; i++)
+		chain_free(&profile->chains[i]);
+	free(profile->chains);
+	free(profile);
+}
+
+void filter_profile_sample(struct filter_profile *profile, struct nlmon_event *event,
+                           struct filter_eval_context *ctx)
+{
+	struct timespec start, end;
+	int result;
+	
+	if (!profile || !event || !ctx)
+		return;
+	
+	for (size_t i = 0; i < profile->chain_count; i++) {
+		struct profile_chain *chain = &profile->chains[i];
+		
+		for (size_t j = 0; j < chain->count; j++) {
+			struct profile_operand *op = &chain->operands[j];
+			
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			result = filter_eval_predicate(op->bytecode, event, ctx);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			
+			op->evals++;
+			op->time_ns += (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL +
+			               (uint64_t)(end.tv_nsec - start.tv_nsec);
+			if (result > 0)
+				op->trues++;
+		}
+	}
+	
+	profile->samples++;
+}
+
+static double operand_cost(const struct profile_operand *op)
+{
+	uint64_t evals = op->evals;
+	
+	return evals ? (double)op->time_ns / (double)evals : 0.0;
+}
+
+/* Chance that the chain goes on past the operand, never quite 0 or 1 */
+static double operand_pass(const struct profile_chain *chain, const struct profile_operand *op)
+{
+	double p_true = ((double)op->trues + 1.0) / ((double)op->evals + 2.0);
+	
+	return chain->type == FILTER_NODE_AND ? p_true : 1.0 - p_true;
+}
+
+/* Cost of the operands in order, each weighted by the chance it runs */
+static double chain_cost(const struct profile_chain *chain, const size_t *order, size_t count)
+{
+	double cost = 0.0, reach = 1.0;
+	
+	for (size_t i = 0; i < count; i++) {
+		const struct profile_operand *op = &chain->operands[order[i]];
+		
+		cost += reach * operand_cost(op);
+		reach *= operand_pass(chain, op);
+	}
+	
+	return cost;
+}
+
+/* Link the operator nodes left deep over the operands in order */
+static void chain_link(struct profile_chain *chain, const size_t *order)
+{
+	size_t last = chain->count - 1;
+	
+	for (size_t i = 0; i < last; i++) {
+		struct filter_node *node = chain->inner[i];
+		
+		node->data.binary.right = chain->operands[order[last - i]].node;
+		node->data.binary.left = i + 1 < last ? chain->inner[i + 1] :
+		                         chain->operands[order[0]].node;
+	}
+	
+	if (order != chain->order)
+		memcpy(chain->order, order, chain->count * sizeof(*order));
+}
+
+/* Predicate calls stay behind the rest by declared cost, as the compiler puts them */
+static bool ranks_after(const struct profile_chain *chain, size_t a, size_t b)
+{
+	uint64_t declared_a = chain->operands[a].declared_ns;
+	uint64_t declared_b = chain->operands[b].declared_ns;
+	
+	if (declared_a != declared_b)
+		return declared_a > declared_b;
+	return chain->rank[a] > chain->rank[b];
+}
+
+/* Sort the operands in front of the first fallible one, returns true if relinked */
+static bool chain_reorder(struct profile_chain *chain)
+{
+	size_t *next = chain->next;
+	double *rank = chain->rank;
+	size_t movable = 0;
+	
+	while (movable < chain->count && !chain->operands[chain->order[movable]].fallible)
+		movable++;
+	if (movable < 2)
+		return false;
+	
+	for (size_t i = 0; i < chain->count; i++) {
+		const struct profile_operand *op = &chain->operands[i];
+		
+		rank[i] = operand_cost(op) / (1.0 - operand_pass(chain, op));
+	}
+	
+	/* Insertion sort keeps the current order among equal ranks */
+	memcpy(next, chain->order, chain->count * sizeof(*next));
+	for (size_t i = 1; i < movable; i++) {
+		size_t op = next[i], j = i;
+		
+		for (; j > 0 && ranks_after(chain, next[j - 1], op); j--)
+			next[j] = next[j - 1];
+		next[j] = op;
+	}
+	
+	if (memcmp(next, chain->order, movable * sizeof(*next)) == 0)
+		return false;
+	
+	/* Operands behind the movable ones run equally often in both orders */
+	if (chain_cost(chain, next, movable) >=
+	    chain_cost(chain, chain->order, movable) * FILTER_PROFILE_GAIN)
+		return false;
+	
+	chain_link(chain, next);
+	return true;
+}
+
+bool filter_profile_reorder(struct filter_profile *profile)
+{
+	bool changed = false;
+	
+	if (!profile || profile->samples < FILTER_PROFILE_MIN_SAMPLES)
+		return false;
+	
+	for (size_t i = 0; i < profile->chain_count; i++) {
+		if (chain_reorder(&profile->chains[i]))
+			changed = true;
+	}
+	
+	return changed;
+}
+
+void filter_profile_restore(struct filter_profile *profile)
+{
+	if (!profile)
+		return;
+	
+	for (size_t i = 0; i < profile->chain_count; i++) {
+		struct profile_chain *chain = &profile->chains[i];
+		
+		for (size_t j = 0; j < chain->count; j++)
+			chain->order[j] = j;
+		chain_link(chain, chain->order);
+	}
+}
+
+uint64_t filter_profile_samples(const struct filter_profile *profile)
+{
+	return profile ? profile->samples : 0;
+}
@@ -0,0 +1,230 @@
+/* filter_regex.c - Compiled regex patterns shared by all contexts
+ *
+ * The store is a chained hash table under one lock, which is only taken
+ * when a context misses its own cache. The first FILTER_REGEX_RETAINED_MAX
+ * patterns stay in it while unused, so contexts evicting filter constants
+ * find them again; patterns beyond that, such as ones taken from event
+ * fields, are freed with their last reference.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "filter_regex.h"
+#include "filter_ac.h"
+
+#define REGEX_TABLE_INITIAL 64
+
+static struct filter_regex **regex_table;
+static size_t regex_table_size;
+static size_t regex_count;
+static size_t regex_retained;
+static pthread_mutex_t regex_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* FNV-1a */
+uint32_t filter_regex_hash(const char *pattern, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)pattern[i];
+		hash *= 16777619u;
+	}
+	
+	return hash;
+}
+
+static void regex_free(struct filter_regex *regex)
+{
+	if (regex->literal)
+		free(regex->literal);
+	else if (!regex->invalid)
+		regfree(&regex->compiled);
+	free(regex->pattern);
+	free(regex);
+}
+
+static struct filter_regex *regex_compile(const char *pattern, size_t len, uint32_t hash)
+{
+	struct filter_regex *regex;
+	
+	regex = calloc(1, sizeof(*regex));
+	if (!regex)
+		return NULL;
+	
+	regex->pattern = strndup(pattern, len);
+	regex->literal = malloc(len + 1);
+	if (!regex->pattern || !regex->literal) {
+		free(regex->literal);
+		free(regex->pattern);
+		free(regex);
+		return NULL;
+	}
+	regex->pattern_len = len;
+	regex->hash = hash;
+	
+	/* Patterns without operators are a substring search */
+	if (filter_ac_literal(pattern, len, regex->literal, &regex->literal_len))
+		return regex;
+	
+	free(regex->literal);
+	regex->literal = NULL;
+	
+	if (regcomp(&regex->compiled, regex->pattern, REG_EXTENDED | REG_NOSUB) != 0)
+		regex->invalid = true;
+	
+	return regex;
+}
+
+/* Double the table, called with regex_lock held */
+static bool regex_table_grow(void)
+{
+	size_t size = regex_table_size ? regex_table_size * 2 : REGEX_TABLE_INITIAL;
+	struct filter_regex **table, *regex, *next;
+	
+	table = calloc(size, sizeof(*table));
+	if (!table)
+		return false;
+	
+	for (size_t i = 0; i < regex_table_size; i++) {
+		for (regex = regex_table[i]; regex; regex = next) {
+			next = regex->next;
+			regex->next = table[regex->hash & (size - 1)];
+			table[regex->hash & (size - 1)] = regex;
+		}
+	}
+	
+	free(regex_table);
+	regex_table = table;
+	regex_table_size = size;
+	return true;
+}
+
+struct filter_regex *filter_regex_get(const char *pattern, size_t len,
+                                      uint32_t hash, bool *compiled)
+{
+	struct filter_regex *regex = NULL;
+	size_t slot;
+	
+	if (compiled)
+		*compiled = false;
+	
+	pthread_mutex_lock(&regex_lock);
+	
+	if (regex_table) {
+		for (regex = regex_table[hash & (regex_table_size - 1)]; regex;
+		     regex = regex->next) {
+			if (regex->hash == hash && regex->pattern_len == len &&
+			    memcmp(regex->pattern, pattern, len) == 0)
+				break;
+		}
+	}
+	
+	if (!regex) {
+		if (regex_count * 2 >= regex_table_size && !regex_table_grow())
+			goto out;
+		
+		/* Compiling under the lock keeps concurrent misses from doing it twice */
+		regex = regex_compile(pattern, len, hash);
+		if (!regex)
+			goto out;
+		
+		if (regex_retained < FILTER_REGEX_RETAINED_MAX) {
+			regex->retained = true;
+			regex->refs++;
+			regex_retained++;
+		}
+		
+		slot = hash & (regex_table_size - 1);
+		regex->next = regex_table[slot];
+		regex_table[slot] = regex;
+		regex_count++;
+		
+		if (compiled)
+			*compiled = true;
+	}
+	
+	regex->refs++;
+	
+out:
+	pthread_mutex_unlock(&regex_lock);
+	return regex;
+}
+
+void filter_regex_put(struct filter_regex *regex)
+{
+	struct filter_regex **link;
+	
+	if (!regex)
+		return;
+	
+	pthread_mutex_lock(&regex_lock);
+	
+	if (--regex->refs > 0) {
+		pthread_mutex_unlock(&regex_lock);
+		return;
+	}
+	
+	for (link = &regex_table[regex->hash & (regex_table_size - 1)]; *link != regex;
+	     link = &(*link)->next)
+		;
+	*link = regex->next;
+	regex_count--;
+	
+	pthread_mutex_unlock(&regex_lock);
+	regex_free(regex);
+}
+
+bool filter_regex_match(const struct filter_regex *regex, const char *text, size_t len)
+{
+	if (regex->invalid)
+		return false;
+	
+	if (regex->literal)
+		return memmem(text, len, regex->literal, regex->literal_len) != NULL;
+	
+#ifdef REG_STARTEND
+	/* Match the view in place, it need not be NUL terminated */
+	regmatch_t range = {
+		.rm_so = 0,
+		.rm_eo = (regoff_t)len,
+	};
+	
+	return regexec(&regex->compiled, text, 1, &range, REG_STARTEND) == 0;
+#else
+	char buf[256];
+	
+	if (len >= sizeof(buf))
+		return false;
+	memcpy(buf, text, len);
+	buf[len] = '\0';
+	
+	return regexec(&regex->compiled, buf, 0, NULL, 0) == 0;
+#endif
+}
+
+void filter_regex_cleanup(void)
+{
+	struct filter_regex *regex, *next;
+	
+	pthread_mutex_lock(&regex_lock);
+	
+	for (size_t i = 0; i < regex_table_size; i++) {
+		for (regex = regex_table[i]; regex; regex = next) {
+			next = regex->next;
+			regex_free(regex);
+		}
+	}
+	
+	free(regex_table);
+	regex_table = NULL;
+	regex_table_size = 0;
+	regex_count = 0;
+	regex_retained = 0;
+	
+	pthread_mutex_unlock(&regex_lock);
+}
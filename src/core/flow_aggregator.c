@@ -0,0 +1,353 @@
+/* flow_aggregator.c - Conntrack events folded into per-interval flow summaries
+ *
+ * The summaries of the current interval live in an id_table keyed by the
+ * seeded hash of their binary key. Finishing an interval swaps the table
+ * for an empty one under the lock and emits the old one after releasing
+ * it, so a slow consumer does not hold up the events of the next one.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+
+#include "flow_aggregator.h"
+#include "event_processor.h"
+#include "nlmon_nl_netfilter.h"
+#include "state_mirror.h"
+#include "id_table.h"
+#include "sketch.h"
+#include "nlmon_clock.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+
+/* Binary key of a summary */
+struct flow_key {
+	uint8_t family;
+	uint8_t protocol;
+	uint16_t src_port;
+	uint16_t dst_port;
+	uint8_t src[16];
+	uint8_t dst[16];
+};
+
+/* Summary of the current interval */
+struct summary_entry {
+	struct id_slot slot;
+	struct flow_key key;
+	struct flow_summary summary;
+};
+
+struct flow_aggregator {
+	struct flow_aggregator_config config;
+	uint64_t interval_ns;
+	uint64_t seed;
+	
+	/* Last counters and age of each flow */
+	struct ct_mirror *flows;
+	
+	pthread_mutex_t lock;
+	struct id_table summaries;
+	struct flow_summary overflow;    /* Keys past max_summaries */
+	uint64_t interval_start;         /* 0 before the first event */
+	
+	struct flow_aggregator_stats stats;
+};
+
+/* Interval summaries handed to the consumer once the lock is released */
+struct finished_interval {
+	struct id_table summaries;
+	struct flow_summary overflow;
+	uint64_t start;
+	uint64_t end;
+};
+
+struct flow_aggregator *flow_aggregator_create(const struct flow_aggregator_config *config)
+{
+	struct flow_aggregator *agg;
+	struct id_table summaries = ID_TABLE_INIT(struct summary_entry);
+	
+	if (!config || !config->emit)
+		return NULL;
+	
+	agg = calloc(1, sizeof(*agg));
+	if (!agg)
+		return NULL;
+	
+	agg->config = *config;
+	if (agg->config.interval == 0)
+		agg->config.interval = FLOW_AGGREGATOR_DEFAULT_INTERVAL;
+	if (agg->config.max_summaries == 0)
+		agg->config.max_summaries = FLOW_AGGREGATOR_DEFAULT_SUMMARIES;
+	agg->interval_ns = (uint64_t)agg->config.interval * NSEC_PER_SEC;
+	agg->summaries = summaries;
+	
+	/* Addresses come from the network, so do not let them pick their slots */
+	agg->seed = nlmon_clock_precise_ns() ^ ((uint64_t)(uintptr_t)agg << 16);
+	
+	agg->flows = ct_mirror_create(agg->config.max_flows);
+	if (!agg->flows || pthread_mutex_init(&agg->lock, NULL) != 0) {
+		ct_mirror_destroy(agg->flows);
+		free(agg);
+		return NULL;
+	}
+	
+	return agg;
+}
+
+void flow_aggregator_destroy(struct flow_aggregator *agg)
+{
+	if (!agg)
+		return;
+	
+	id_table_free(&agg->summaries);
+	ct_mirror_destroy(agg->flows);
+	pthread_mutex_destroy(&agg->lock);
+	free(agg);
+}
+
+/* Key of the summary an event goes to, -EINVAL for a flow without addresses */
+static int flow_key(struct flow_aggregator *agg, const struct nlmon_ct_info *ct,
+                    struct flow_key *key)
+{
+	int family = strchr(ct->src_addr, ':') ? AF_INET6 : AF_INET;
+	
+	memset(key, 0, sizeof(*key));
+	if (inet_pton(family, ct->src_addr, key->src) != 1 ||
+	    inet_pton(family, ct->dst_addr, key->dst) != 1)
+		return -EINVAL;
+	
+	key->family = (uint8_t)family;
+	key->protocol = ct->protocol;
+	if (agg->config.key == FLOW_KEY_TUPLE) {
+		key->src_port = ct->src_port;
+		key->dst_port = ct->dst_port;
+	}
+	return 0;
+}
+
+/* Summary of a key, the overflow summary when the table is full or on a
+ * collision of hashes. Called with the lock held. */
+static struct flow_summary *summary_get(struct flow_aggregator *agg, const struct flow_key *key,
+                                        const struct nlmon_ct_info *ct)
+{
+	uint64_t hash = sketch_hash(key, sizeof(*key), agg->seed);
+	struct summary_entry *entry;
+	int created;
+	
+	entry = id_table_find(&agg->summaries, hash);
+	if (entry)
+		return memcmp(&entry->key, key, sizeof(*key)) == 0 ? &entry->summary : NULL;
+	
+	if (agg->summaries.used >= agg->config.max_summaries)
+		return NULL;
+	
+	entry = id_table_get(&agg->summaries, hash, &created);
+	if (!entry)
+		return NULL;
+	
+	entry->key = *key;
+	entry->summary.family = key->family;
+	entry->summary.protocol = key->protocol;
+	memcpy(entry->summary.src_addr, ct->src_addr, sizeof(entry->summary.src_addr));
+	memcpy(entry->summary.dst_addr, ct->dst_addr, sizeof(entry->summary.dst_addr));
+	entry->summary.src_port = key->src_port;
+	entry->summary.dst_port = key->dst_port;
+	return &entry->summary;
+}
+
+/* Growth of a cumulative counter, all of it if the counter went back */
+static uint64_t counter_delta(uint64_t now, uint64_t before)
+{
+	return now >= before ? now - before : now;
+}
+
+/* Take the summaries of the current interval out. Called with the lock held. */
+static void interval_detach(struct flow_aggregator *agg, struct finished_interval *out)
+{
+	struct id_table empty = ID_TABLE_INIT(struct summary_entry);
+	
+	out->summaries = agg->summaries;
+	out->overflow = agg->overflow;
+	out->start = agg->interval_start;
+	out->end = agg->interval_start + agg->interval_ns;
+	
+	agg->summaries = empty;
+	memset(&agg->overflow, 0, sizeof(agg->overflow));
+	agg->interval_start = 0;
+	if (out->start)
+		agg->stats.intervals++;
+}
+
+/* Hand the summaries of a finished interval to the consumer, without the lock */
+static size_t interval_emit(struct flow_aggregator *agg, struct finished_interval *done)
+{
+	struct summary_entry *entry;
+	size_t emitted = 0;
+	size_t i;
+	
+	for (i = 0; i < done->summaries.size; i++) {
+		entry = (struct summary_entry *)id_table_slot(&done->summaries, i);
+		if (!entry->slot.used)
+			continue;
+		entry->summary.interval_start = done->start;
+		entry->summary.interval_end = done->end;
+		agg->config.emit(&entry->summary, agg->config.emit_ctx);
+		emitted++;
+	}
+	
+	if (done->overflow.events) {
+		done->overflow.interval_start = done->start;
+		done->overflow.interval_end = done->end;
+		agg->config.emit(&done->overflow, agg->config.emit_ctx);
+		emitted++;
+	}
+	
+	id_table_free(&done->summaries);
+	
+	pthread_mutex_lock(&agg->lock);
+	agg->stats.summaries_emitted += emitted;
+	pthread_mutex_unlock(&agg->lock);
+	
+	return emitted;
+}
+
+bool flow_aggregator_process(struct flow_aggregator *agg, struct nlmon_event *event)
+{
+	struct finished_interval done = { .start = 0 };
+	struct ct_mirror_entry before;
+	struct flow_summary *summary;
+	struct nlmon_ct_info *ct;
+	struct flow_key key;
+	uint64_t ts, start;
+	uint16_t type;
+	bool known, passed;
+	
+	if (!agg || !event)
+		return true;
+	if (event->netlink.protocol != NETLINK_NETFILTER ||
+	    NFNL_SUBSYS_ID(event->netlink.msg_type) != NFNL_SUBSYS_CTNETLINK)
+		return true;
+	
+	type = NFNL_MSG_TYPE(event->netlink.msg_type);
+	if (type != IPCTNL_MSG_CT_NEW && type != IPCTNL_MSG_CT_DELETE)
+		return true;
+	
+	nlmon_event_materialize(event);
+	ct = event->netlink.data.conntrack;
+	if (!ct || flow_key(agg, ct, &key) < 0)
+		return true;
+	
+	passed = agg->config.passthrough &&
+	         agg->config.passthrough(event, agg->config.passthrough_ctx);
+	
+	ts = event->timestamp ? event->timestamp : nlmon_clock_realtime_ns();
+	start = ts - ts % agg->interval_ns;
+	
+	pthread_mutex_lock(&agg->lock);
+	
+	/* A later interval finishes this one, a late event joins it */
+	if (agg->interval_start && start > agg->interval_start)
+		interval_detach(agg, &done);
+	if (!agg->interval_start)
+		agg->interval_start = start;
+	
+	/* The mirror keeps nanoseconds, for the lifetimes of flows */
+	known = ct_mirror_lookup(agg->flows, ct, &before);
+	if (!known)
+		memset(&before, 0, sizeof(before));
+	ct_mirror_update(agg->flows, type, ct, (time_t)ts);
+	
+	summary = summary_get(agg, &key, ct);
+	if (!summary) {
+		summary = &agg->overflow;
+		agg->stats.overflowed++;
+	}
+	
+	if (!summary->events || ts < summary->first_event)
+		summary->first_event = ts;
+	if (ts > summary->last_event)
+		summary->last_event = ts;
+	summary->events++;
+	
+	/* Updates and dumps of existing flows come without NLM_F_CREATE */
+	if (type == IPCTNL_MSG_CT_NEW && (event->netlink.msg_flags & NLM_F_CREATE))
+		summary->flows_new++;
+	
+	/* Destroy events carry the final counters, zero when not accounted */
+	if (ct->packets_orig || ct->packets_reply) {
+		summary->packets_orig += counter_delta(ct->packets_orig, before.packets_orig);
+		summary->packets_reply += counter_delta(ct->packets_reply, before.packets_reply);
+		summary->bytes_orig += counter_delta(ct->bytes_orig, before.bytes_orig);
+		summary->bytes_reply += counter_delta(ct->bytes_reply, before.bytes_reply);
+	}
+	
+	if (type == IPCTNL_MSG_CT_DELETE) {
+		summary->flows_destroyed++;
+		if (known && ts > (uint64_t)before.first_seen) {
+			uint64_t lifetime = ts - (uint64_t)before.first_seen;
+			
+			summary->duration_total_ns += lifetime;
+			if (lifetime > summary->duration_max_ns)
+				summary->duration_max_ns = lifetime;
+		}
+	}
+	
+	agg->stats.events_folded++;
+	if (passed)
+		agg->stats.events_passed++;
+	
+	pthread_mutex_unlock(&agg->lock);
+	
+	if (done.start)
+		interval_emit(agg, &done);
+	
+	return passed;
+}
+
+size_t flow_aggregator_tick(struct flow_aggregator *agg, uint64_t now)
+{
+	struct finished_interval done = { .start = 0 };
+	
+	if (!agg)
+		return 0;
+	
+	pthread_mutex_lock(&agg->lock);
+	if (agg->interval_start && now >= agg->interval_start + agg->interval_ns)
+		interval_detach(agg, &done);
+	pthread_mutex_unlock(&agg->lock);
+	
+	return done.start ? interval_emit(agg, &done) : 0;
+}
+
+size_t flow_aggregator_flush(struct flow_aggregator *agg)
+{
+	struct finished_interval done = { .start = 0 };
+	
+	if (!agg)
+		return 0;
+	
+	pthread_mutex_lock(&agg->lock);
+	if (agg->interval_start)
+		interval_detach(agg, &done);
+	pthread_mutex_unlock(&agg->lock);
+	
+	return done.start ? interval_emit(agg, &done) : 0;
+}
+
+void flow_aggregator_get_stats(struct flow_aggregator *agg, struct flow_aggregator_stats *stats)
+{
+	if (!agg || !stats)
+		return;
+	
+	pthread_mutex_lock(&agg->lock);
+	*stats = agg->stats;
+	stats->summaries = agg->summaries.used;
+	pthread_mutex_unlock(&agg->lock);
+}
@@ -0,0 +1,353 @@
+/* hdr_histogram.c - Log-linear histograms with lock-free recording
+ *
+ * A value is split by frexp() into frac * 2^exp with frac in [0.5, 1).
+ * The bucket key is j + (exp - 1) * 2^schema, where j is the first of
+ * the 2^schema sub-bucket bounds 2^(j / 2^schema - 1) that is at least
+ * frac, found by binary search. This is how Prometheus client libraries
+ * compute native histogram keys, so the buckets line up with theirs.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <math.h>
+#include "hdr_histogram.h"
+
+struct hdr_histogram {
+	int schema;
+	int min_key;                    /* Key of counts[0] */
+	int max_key;
+	size_t size;
+	double *bounds;                 /* 2^schema sub-bucket bounds in [0.5, 1) */
+	_Atomic uint64_t *counts;
+	
+	_Atomic uint64_t count;
+	_Atomic uint64_t zero_count;
+	_Atomic uint64_t sum;           /* Bits of a double */
+	_Atomic uint64_t min;           /* Bits of a double */
+	_Atomic uint64_t max;           /* Bits of a double */
+};
+
+static inline uint64_t double_bits(double value)
+{
+	uint64_t bits;
+	
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static inline double bits_double(uint64_t bits)
+{
+	double value;
+	
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+/* Sub-bucket bound j of a schema with n sub-buckets */
+static inline double sub_bound(int j, int n)
+{
+	return exp2((double)j / n - 1);
+}
+
+struct hdr_histogram *hdr_histogram_create(int schema)
+{
+	struct hdr_histogram *h;
+	int n, j;
+	
+	if (schema < HDR_HISTOGRAM_MIN_SCHEMA || schema > HDR_HISTOGRAM_MAX_SCHEMA)
+		return NULL;
+	
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return NULL;
+	
+	n = 1 << schema;
+	h->schema = schema;
+	h->min_key = HDR_HISTOGRAM_MIN_EXP * n + 1;
+	h->max_key = HDR_HISTOGRAM_MAX_EXP * n;
+	h->size = (size_t)(h->max_key - h->min_key + 1);
+	
+	h->bounds = malloc(n * sizeof(*h->bounds));
+	if (!h->bounds)
+		goto err_free;
+	
+	for (j = 0; j < n; j++)
+		h->bounds[j] = sub_bound(j, n);
+	
+	h->counts = calloc(h->size, sizeof(*h->counts));
+	if (!h->counts)
+		goto err_bounds;
+	
+	atomic_init(&h->sum, double_bits(0.0));
+	atomic_init(&h->min, double_bits(INFINITY));
+	atomic_init(&h->max, double_bits(-INFINITY));
+	return h;
+	
+err_bounds:
+	free(h->bounds);
+err_free:
+	free(h);
+	return NULL;
+}
+
+void hdr_histogram_destroy(struct hdr_histogram *h)
+{
+	if (!h)
+		return;
+	
+	free(h->counts);
+	free(h->bounds);
+	free(h);
+}
+
+/* Key of a value above the zero threshold, clamped to the top bucket */
+static int key_of(const struct hdr_histogram *h, double value)
+{
+	int n = 1 << h->schema;
+	int lo = 0, hi = n;
+	int exp, key;
+	double frac;
+	
+	if (isinf(value))
+		return h->max_key;
+	
+	frac = frexp(value, &exp);
+	
+	/* First bound at least frac, n if frac is above them all */
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		
+		if (h->bounds[mid] >= frac)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	
+	key = lo + (exp - 1) * n;
+	return key > h->max_key ? h->max_key : key;
+}
+
+void hdr_histogram_record(struct hdr_histogram *h, double value)
+{
+	uint64_t old;
+	
+	if (isnan(value))
+		return;
+	
+	atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+	
+	old = atomic_load_explicit(&h->sum, memory_order_relaxed);
+	while (!atomic_compare_exchange_weak_explicit(&h->sum, &old,
+	                                              double_bits(bits_double(old) + value),
+	                                              memory_order_relaxed,
+	                                              memory_order_relaxed))
+		;
+	
+	/* Min and max settle quickly, most values only load them */
+	old = atomic_load_explicit(&h->min, memory_order_relaxed);
+	while (value < bits_double(old) &&
+	       !atomic_compare_exchange_weak_explicit(&h->min, &old, double_bits(value),
+	                                              memory_order_relaxed,
+	                                              memory_order_relaxed))
+		;
+	
+	old = atomic_load_explicit(&h->max, memory_order_relaxed);
+	while (value > bits_double(old) &&
+	       !atomic_compare_exchange_weak_explicit(&h->max, &old, double_bits(value),
+	                                              memory_order_relaxed,
+	                                              memory_order_relaxed))
+		;
+	
+	if (value <= HDR_HISTOGRAM_ZERO_THRESHOLD) {
+		atomic_fetch_add_explicit(&h->zero_count, 1, memory_order_relaxed);
+		return;
+	}
+	
+	atomic_fetch_add_explicit(&h->counts[key_of(h, value) - h->min_key], 1,
+	                          memory_order_relaxed);
+}
+
+void hdr_histogram_reset(struct hdr_histogram *h)
+{
+	size_t i;
+	
+	for (i = 0; i < h->size; i++)
+		atomic_store_explicit(&h->counts[i], 0, memory_order_relaxed);
+	
+	atomic_store_explicit(&h->count, 0, memory_order_relaxed);
+	atomic_store_explicit(&h->zero_count, 0, memory_order_relaxed);
+	atomic_store_explicit(&h->sum, double_bits(0.0), memory_order_relaxed);
+	atomic_store_explicit(&h->min, double_bits(INFINITY), memory_order_relaxed);
+	atomic_store_explicit(&h->max, double_bits(-INFINITY), memory_order_relaxed);
+}
+
+void hdr_histogram_merge(struct hdr_histogram *dst, const struct hdr_histogram *src)
+{
+	double min = hdr_histogram_min(src), max = hdr_histogram_max(src);
+	int key = HDR_HISTOGRAM_FIRST_KEY;
+	uint64_t count, old;
+	
+	atomic_fetch_add_explicit(&dst->count, hdr_histogram_count(src), memory_order_relaxed);
+	atomic_fetch_add_explicit(&dst->zero_count, hdr_histogram_zero_count(src),
+	                          memory_order_relaxed);
+	
+	old = atomic_load_explicit(&dst->sum, memory_order_relaxed);
+	while (!atomic_compare_exchange_weak_explicit(&dst->sum, &old,
+	                                              double_bits(bits_double(old) +
+	                                                          hdr_histogram_sum(src)),
+	                                              memory_order_relaxed,
+	                                              memory_order_relaxed))
+		;
+	
+	old = atomic_load_explicit(&dst->min, memory_order_relaxed);
+	while (min < bits_double(old) &&
+	       !atomic_compare_exchange_weak_explicit(&dst->min, &old, double_bits(min),
+	                                              memory_order_relaxed,
+	                                              memory_order_relaxed))
+		;
+	
+	old = atomic_load_explicit(&dst->max, memory_order_relaxed);
+	while (max > bits_double(old) &&
+	       !atomic_compare_exchange_weak_explicit(&dst->max, &old, double_bits(max),
+	                                              memory_order_relaxed,
+	                                              memory_order_relaxed))
+		;
+	
+	while (hdr_histogram_next_bucket(src, &key, &count)) {
+		int to = key;
+		
+		if (src->schema != dst->schema)
+			to = key_of(dst, hdr_histogram_bucket_upper(src->schema, key));
+		atomic_fetch_add_explicit(&dst->counts[to - dst->min_key], count,
+		                          memory_order_relaxed);
+	}
+}
+
+int hdr_histogram_schema(const struct hdr_histogram *h)
+{
+	return h->schema;
+}
+
+uint64_t hdr_histogram_count(const struct hdr_histogram *h)
+{
+	return atomic_load_explicit(&h->count, memory_order_relaxed);
+}
+
+double hdr_histogram_sum(const struct hdr_histogram *h)
+{
+	return bits_double(atomic_load_explicit(&h->sum, memory_order_relaxed));
+}
+
+double hdr_histogram_min(const struct hdr_histogram *h)
+{
+	return bits_double(atomic_load_explicit(&h->min, memory_order_relaxed));
+}
+
+double hdr_histogram_max(const struct hdr_histogram *h)
+{
+	return bits_double(atomic_load_explicit(&h->max, memory_order_relaxed));
+}
+
+uint64_t hdr_histogram_zero_count(const struct hdr_histogram *h)
+{
+	return atomic_load_explicit(&h->zero_count, memory_order_relaxed);
+}
+
+bool hdr_histogram_next_bucket(const struct hdr_histogram *h, int *key, uint64_t *count)
+{
+	size_t i = 0;
+	
+	if (*key != HDR_HISTOGRAM_FIRST_KEY) {
+		if (*key >= h->max_key)
+			return false;
+		if (*key >= h->min_key)
+			i = (size_t)(*key - h->min_key) + 1;
+	}
+	
+	for (; i < h->size; i++) {
+		uint64_t c = atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+		
+		if (c) {
+			*key = h->min_key + (int)i;
+			*count = c;
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+double hdr_histogram_bucket_upper(int schema, int key)
+{
+	int n = 1 << schema;
+	int j = ((key % n) + n) % n;
+	
+	/* Same arithmetic as the bounds key_of() searches */
+	return ldexp(sub_bound(j, n), (key - j) / n + 1);
+}
+
+uint64_t hdr_histogram_count_at_most(const struct hdr_histogram *h, double bound)
+{
+	uint64_t total;
+	int key, i;
+	
+	if (isnan(bound) || bound < HDR_HISTOGRAM_ZERO_THRESHOLD)
+		return 0;
+	
+	total = hdr_histogram_zero_count(h);
+	if (bound == HDR_HISTOGRAM_ZERO_THRESHOLD)
+		return total;
+	
+	key = key_of(h, bound);
+	if (!isinf(bound) && hdr_histogram_bucket_upper(h->schema, key) > bound)
+		key--;
+	
+	for (i = 0; i <= key - h->min_key; i++)
+		total += atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+	
+	return total;
+}
+
+double hdr_histogram_quantile(const struct hdr_histogram *h, double q)
+{
+	uint64_t count = hdr_histogram_count(h);
+	double min = hdr_histogram_min(h);
+	double max = hdr_histogram_max(h);
+	double rank, cum;
+	size_t i;
+	
+	if (count == 0)
+		return NAN;
+	
+	if (q < 0)
+		q = 0;
+	if (q > 1)
+		q = 1;
+	
+	rank = q * (double)count;
+	cum = (double)hdr_histogram_zero_count(h);
+	if (cum > 0 && rank <= cum)
+		return fmin(fmax(0.0, min), max);
+	
+	for (i = 0; i < h->size; i++) {
+		uint64_t c = atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+		int key = h->min_key + (int)i;
+		double lower, upper, value;
+		
+		if (!c)
+			continue;
+		
+		if (cum + (double)c >= rank) {
+			lower = i ? hdr_histogram_bucket_upper(h->schema, key - 1)
+			          : HDR_HISTOGRAM_ZERO_THRESHOLD;
+			upper = hdr_histogram_bucket_upper(h->schema, key);
+			value = lower + (upper - lower) * ((rank - cum) / (double)c);
+			return fmin(fmax(value, min), max);
+		}
+		
+		cum += (double)c;
+	}
+	
+	return max;
+}
@@ -0,0 +1,690 @@
+/* hot_upgrade.c - Socket handoff and state transfer between processes */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "hot_upgrade.h"
+#include "fib_mirror.h"
+#include "state_mirror.h"
+
+/* Control messages of the exchange */
+enum upgrade_code {
+	UPGRADE_REQUEST = 1,            /* New process asks for the sockets */
+	UPGRADE_DONE = 2,               /* New process reports the outcome */
+};
+
+struct upgrade_control {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t code;
+	int32_t status;
+};
+
+/* Sent with the sockets attached */
+struct upgrade_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t nfds;
+	uint32_t nsections;
+	uint32_t roles[NLMON_UPGRADE_MAX_FDS];
+};
+
+/* Precedes the contents of each section */
+struct upgrade_section_header {
+	uint32_t type;
+	uint32_t record_size;           /* 0 for a plain section */
+	uint64_t len;
+};
+
+struct upgrade_section {
+	uint32_t type;
+	uint32_t record_size;
+	size_t len;
+	void *data;
+};
+
+struct nlmon_upgrade {
+	unsigned int nfds;
+	uint32_t roles[NLMON_UPGRADE_MAX_FDS];
+	int fds[NLMON_UPGRADE_MAX_FDS];
+	bool received;                  /* The fds are ours to close */
+	struct upgrade_section *sections;
+	unsigned int nsections;
+};
+
+struct nlmon_upgrade *nlmon_upgrade_create(void)
+{
+	return calloc(1, sizeof(struct nlmon_upgrade));
+}
+
+void nlmon_upgrade_destroy(struct nlmon_upgrade *up)
+{
+	unsigned int i;
+
+	if (!up)
+		return;
+
+	if (up->received) {
+		for (i = 0; i < up->nfds; i++) {
+			if (up->fds[i] >= 0)
+				close(up->fds[i]);
+		}
+	}
+
+	for (i = 0; i < up->nsections; i++)
+		free(up->sections[i].data);
+	free(up->sections);
+	free(up);
+}
+
+int nlmon_upgrade_add_fd(struct nlmon_upgrade *up, unsigned int role, int fd)
+{
+	unsigned int i;
+
+	if (!up || !role || fd < 0 || up->received)
+		return -EINVAL;
+
+	for (i = 0; i < up->nfds; i++) {
+		if (up->roles[i] == role)
+			return -EEXIST;
+	}
+	if (up->nfds == NLMON_UPGRADE_MAX_FDS)
+		return -ENOSPC;
+
+	up->roles[up->nfds] = role;
+	up->fds[up->nfds] = fd;
+	up->nfds++;
+	return 0;
+}
+
+int nlmon_upgrade_take_fd(struct nlmon_upgrade *up, unsigned int role)
+{
+	unsigned int i;
+	int fd;
+
+	if (!up || !up->received)
+		return -1;
+
+	for (i = 0; i < up->nfds; i++) {
+		if (up->roles[i] == role && up->fds[i] >= 0) {
+			fd = up->fds[i];
+			up->fds[i] = -1;
+			return fd;
+		}
+	}
+	return -1;
+}
+
+static struct upgrade_section *section_find(const struct nlmon_upgrade *up, uint32_t type)
+{
+	unsigned int i;
+
+	for (i = 0; i < up->nsections; i++) {
+		if (up->sections[i].type == type)
+			return &up->sections[i];
+	}
+	return NULL;
+}
+
+/* Append a section, taking @data */
+static int section_append(struct nlmon_upgrade *up, uint32_t type, uint32_t record_size,
+                          void *data, size_t len)
+{
+	struct upgrade_section *sections;
+
+	sections = realloc(up->sections, (up->nsections + 1) * sizeof(*sections));
+	if (!sections)
+		return -ENOMEM;
+	up->sections = sections;
+
+	sections[up->nsections].type = type;
+	sections[up->nsections].record_size = record_size;
+	sections[up->nsections].len = len;
+	sections[up->nsections].data = data;
+	up->nsections++;
+	return 0;
+}
+
+static int section_add(struct nlmon_upgrade *up, uint32_t type, uint32_t record_size,
+                       const void *data, size_t len)
+{
+	void *copy;
+	int ret;
+
+	if (!up || !type || (len && !data) || up->received)
+		return -EINVAL;
+	if (section_find(up, type))
+		return -EEXIST;
+	if (len > NLMON_UPGRADE_MAX_SECTION)
+		return -E2BIG;
+
+	/* One byte even when empty, malloc(0) may return NULL */
+	copy = malloc(len ? len : 1);
+	if (!copy)
+		return -ENOMEM;
+	if (len)
+		memcpy(copy, data, len);
+
+	ret = section_append(up, type, record_size, copy, len);
+	if (ret < 0)
+		free(copy);
+	return ret;
+}
+
+int nlmon_upgrade_add_section(struct nlmon_upgrade *up, uint32_t type,
+                              const void *data, size_t len)
+{
+	return section_add(up, type, 0, data, len);
+}
+
+int nlmon_upgrade_add_records(struct nlmon_upgrade *up, uint32_t type,
+                              const void *records, size_t size, size_t count)
+{
+	if (!size || size > UINT32_MAX)
+		return -EINVAL;
+	if (count > NLMON_UPGRADE_MAX_SECTION / size)
+		return -E2BIG;
+	return section_add(up, type, (uint32_t)size, records, size * count);
+}
+
+const void *nlmon_upgrade_get_section(const struct nlmon_upgrade *up, uint32_t type,
+                                      size_t *len)
+{
+	const struct upgrade_section *sec = up ? section_find(up, type) : NULL;
+
+	if (len)
+		*len = sec ? sec->len : 0;
+	return sec ? sec->data : NULL;
+}
+
+const void *nlmon_upgrade_get_records(const struct nlmon_upgrade *up, uint32_t type,
+                                      size_t size, size_t *count)
+{
+	const struct upgrade_section *sec = up ? section_find(up, type) : NULL;
+
+	*count = 0;
+	if (!sec || !size || sec->record_size != size || sec->len % size)
+		return NULL;
+
+	*count = sec->len / size;
+	return sec->data;
+}
+
+/* Mirrors */
+
+/* Records collected by a walk */
+struct record_buf {
+	char *data;
+	size_t size;
+	size_t count;
+	size_t capacity;
+	bool failed;
+};
+
+static bool record_push(struct record_buf *buf, const void *record)
+{
+	size_t capacity;
+	char *data;
+
+	if (buf->count == buf->capacity) {
+		capacity = buf->capacity ? buf->capacity * 2 : 256;
+		data = realloc(buf->data, capacity * buf->size);
+		if (!data) {
+			buf->failed = true;
+			return false;
+		}
+		buf->data = data;
+		buf->capacity = capacity;
+	}
+
+	memcpy(buf->data + buf->count * buf->size, record, buf->size);
+	buf->count++;
+	return true;
+}
+
+static bool fib_collect(const struct fib_mirror_route *route, void *ctx)
+{
+	return record_push(ctx, route);
+}
+
+static bool neigh_collect(const struct neigh_mirror_entry *entry, void *ctx)
+{
+	return record_push(ctx, entry);
+}
+
+static bool ct_collect(const struct ct_mirror_entry *entry, void *ctx)
+{
+	return record_push(ctx, entry);
+}
+
+static int record_finish(struct nlmon_upgrade *up, uint32_t type, struct record_buf *buf)
+{
+	int ret = buf->failed ? -ENOMEM :
+	          nlmon_upgrade_add_records(up, type, buf->data, buf->size, buf->count);
+
+	free(buf->data);
+	return ret;
+}
+
+int nlmon_upgrade_add_fib(struct nlmon_upgrade *up, struct fib_mirror *fib)
+{
+	struct record_buf buf = { .size = sizeof(struct fib_mirror_route) };
+
+	if (!up || !fib)
+		return -EINVAL;
+	fib_mirror_walk_all(fib, fib_collect, &buf);
+	return record_finish(up, NLMON_UPGRADE_SEC_FIB_MIRROR, &buf);
+}
+
+int nlmon_upgrade_add_neigh(struct nlmon_upgrade *up, struct neigh_mirror *mirror)
+{
+	struct record_buf buf = { .size = sizeof(struct neigh_mirror_entry) };
+
+	if (!up || !mirror)
+		return -EINVAL;
+	neigh_mirror_walk(mirror, neigh_collect, &buf);
+	return record_finish(up, NLMON_UPGRADE_SEC_NEIGH_MIRROR, &buf);
+}
+
+int nlmon_upgrade_add_ct(struct nlmon_upgrade *up, struct ct_mirror *mirror)
+{
+	struct record_buf buf = { .size = sizeof(struct ct_mirror_entry) };
+
+	if (!up || !mirror)
+		return -EINVAL;
+	ct_mirror_walk(mirror, ct_collect, &buf);
+	return record_finish(up, NLMON_UPGRADE_SEC_CT_MIRROR, &buf);
+}
+
+long nlmon_upgrade_restore_fib(const struct nlmon_upgrade *up, struct fib_mirror *fib)
+{
+	const struct fib_mirror_route *routes;
+	size_t count, i;
+	long restored = 0;
+
+	routes = nlmon_upgrade_get_records(up, NLMON_UPGRADE_SEC_FIB_MIRROR,
+	                                   sizeof(*routes), &count);
+	for (i = 0; i < count; i++) {
+		if (fib_mirror_restore(fib, &routes[i]) >= 0)
+			restored++;
+	}
+	return restored;
+}
+
+/* Walks start at the most recent entry, restore from the oldest */
+
+long nlmon_upgrade_restore_neigh(const struct nlmon_upgrade *up, struct neigh_mirror *mirror)
+{
+	const struct neigh_mirror_entry *entries;
+	size_t count;
+	long restored = 0;
+
+	entries = nlmon_upgrade_get_records(up, NLMON_UPGRADE_SEC_NEIGH_MIRROR,
+	                                    sizeof(*entries), &count);
+	while (count--) {
+		if (neigh_mirror_restore(mirror, &entries[count]) >= 0)
+			restored++;
+	}
+	return restored;
+}
+
+long nlmon_upgrade_restore_ct(const struct nlmon_upgrade *up, struct ct_mirror *mirror)
+{
+	const struct ct_mirror_entry *entries;
+	size_t count;
+	long restored = 0;
+
+	entries = nlmon_upgrade_get_records(up, NLMON_UPGRADE_SEC_CT_MIRROR,
+	                                    sizeof(*entries), &count);
+	while (count--) {
+		if (ct_mirror_restore(mirror, &entries[count]) >= 0)
+			restored++;
+	}
+	return restored;
+}
+
+/* Connection */
+
+static int upgrade_addr(const char *path, struct sockaddr_un *addr)
+{
+	if (!path || !path[0])
+		return -EINVAL;
+	if (strlen(path) >= sizeof(addr->sun_path))
+		return -ENAMETOOLONG;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+/* No step of the exchange may hang either process */
+static void upgrade_set_timeout(int fd)
+{
+	struct timeval tv = {
+		.tv_sec = NLMON_UPGRADE_TIMEOUT_MS / 1000,
+		.tv_usec = (NLMON_UPGRADE_TIMEOUT_MS % 1000) * 1000,
+	};
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+int nlmon_upgrade_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd, ret;
+
+	ret = upgrade_addr(path, &addr);
+	if (ret < 0)
+		return ret;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	/* A previous process is gone or has handed over, its socket with it */
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+	return fd;
+}
+
+int nlmon_upgrade_accept(int listen_fd)
+{
+	int fd;
+
+	fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return errno == EWOULDBLOCK ? -EAGAIN : -errno;
+
+	upgrade_set_timeout(fd);
+	return fd;
+}
+
+int nlmon_upgrade_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd, ret;
+
+	ret = upgrade_addr(path, &addr);
+	if (ret < 0)
+		return ret;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	upgrade_set_timeout(fd);
+	return fd;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN ? -ETIMEDOUT : -errno;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = recv(fd, p, len, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN ? -ETIMEDOUT : -errno;
+		}
+		if (n == 0)
+			return -ECONNRESET;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int control_send(int conn, uint16_t code, int32_t status)
+{
+	struct upgrade_control msg = {
+		.magic = NLMON_UPGRADE_MAGIC,
+		.version = NLMON_UPGRADE_VERSION,
+		.code = code,
+		.status = status,
+	};
+
+	return write_full(conn, &msg, sizeof(msg));
+}
+
+static int control_recv(int conn, uint16_t code, int32_t *status)
+{
+	struct upgrade_control msg;
+	int ret;
+
+	ret = read_full(conn, &msg, sizeof(msg));
+	if (ret < 0)
+		return ret;
+	if (msg.magic != NLMON_UPGRADE_MAGIC || msg.version != NLMON_UPGRADE_VERSION ||
+	    msg.code != code)
+		return -EPROTO;
+
+	if (status)
+		*status = msg.status;
+	return 0;
+}
+
+int nlmon_upgrade_request(int conn)
+{
+	return control_send(conn, UPGRADE_REQUEST, 0);
+}
+
+int nlmon_upgrade_wait_request(int conn)
+{
+	return control_recv(conn, UPGRADE_REQUEST, NULL);
+}
+
+int nlmon_upgrade_done(int conn, int status)
+{
+	return control_send(conn, UPGRADE_DONE, status > 0 ? 0 : status);
+}
+
+int nlmon_upgrade_wait_done(int conn)
+{
+	struct timeval tv = {
+		.tv_sec = NLMON_UPGRADE_START_TIMEOUT_MS / 1000,
+		.tv_usec = (NLMON_UPGRADE_START_TIMEOUT_MS % 1000) * 1000,
+	};
+	int32_t status;
+	int ret;
+
+	/* It opens every other socket before it answers */
+	setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	ret = control_recv(conn, UPGRADE_DONE, &status);
+	return ret < 0 ? ret : status;
+}
+
+int nlmon_upgrade_send(int conn, const struct nlmon_upgrade *up)
+{
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * NLMON_UPGRADE_MAX_FDS)];
+		struct cmsghdr align;
+	} control;
+	struct upgrade_header hdr;
+	struct iovec iov = { &hdr, sizeof(hdr) };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+	struct cmsghdr *cmsg;
+	unsigned int i;
+	ssize_t n;
+	int ret;
+
+	if (!up || up->received)
+		return -EINVAL;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = NLMON_UPGRADE_MAGIC;
+	hdr.version = NLMON_UPGRADE_VERSION;
+	hdr.nfds = (uint16_t)up->nfds;
+	hdr.nsections = up->nsections;
+	memcpy(hdr.roles, up->roles, up->nfds * sizeof(up->roles[0]));
+
+	if (up->nfds) {
+		memset(&control, 0, sizeof(control));
+		msg.msg_control = control.buf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * up->nfds);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * up->nfds);
+		memcpy(CMSG_DATA(cmsg), up->fds, sizeof(int) * up->nfds);
+	}
+
+	do {
+		n = sendmsg(conn, &msg, MSG_NOSIGNAL);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0)
+		return errno == EAGAIN ? -ETIMEDOUT : -errno;
+
+	/* The sockets went with the first byte, the rest is plain data */
+	ret = write_full(conn, (char *)&hdr + n, sizeof(hdr) - n);
+
+	for (i = 0; ret == 0 && i < up->nsections; i++) {
+		const struct upgrade_section *sec = &up->sections[i];
+		struct upgrade_section_header sh = {
+			.type = sec->type,
+			.record_size = sec->record_size,
+			.len = sec->len,
+		};
+
+		ret = write_full(conn, &sh, sizeof(sh));
+		if (ret == 0)
+			ret = write_full(conn, sec->data, sec->len);
+	}
+
+	return ret;
+}
+
+/* Receive the header and the sockets sent with it */
+static int recv_header(int conn, struct upgrade_header *hdr, struct nlmon_upgrade *up)
+{
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * NLMON_UPGRADE_MAX_FDS)];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = { hdr, sizeof(*hdr) };
+	struct msghdr msg = {
+		.msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = control.buf, .msg_controllen = sizeof(control.buf),
+	};
+	struct cmsghdr *cmsg;
+	unsigned int count = 0, i;
+	ssize_t n;
+
+	do {
+		n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0)
+		return errno == EAGAIN ? -ETIMEDOUT : -errno;
+	if (n == 0)
+		return -ECONNRESET;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(up->fds, CMSG_DATA(cmsg), count * sizeof(int));
+		break;
+	}
+	up->nfds = count;
+
+	if (msg.msg_flags & MSG_CTRUNC)
+		return -EPROTO;
+	if ((size_t)n < sizeof(*hdr) && read_full(conn, (char *)hdr + n, sizeof(*hdr) - n) < 0)
+		return -ECONNRESET;
+
+	if (hdr->magic != NLMON_UPGRADE_MAGIC || hdr->version != NLMON_UPGRADE_VERSION ||
+	    hdr->nfds != count)
+		return -EPROTO;
+
+	for (i = 0; i < count; i++)
+		up->roles[i] = hdr->roles[i];
+	return 0;
+}
+
+int nlmon_upgrade_recv(int conn, struct nlmon_upgrade **out)
+{
+	struct upgrade_section_header sh;
+	struct upgrade_header hdr;
+	struct nlmon_upgrade *up;
+	unsigned int i;
+	void *data;
+	int ret;
+
+	*out = NULL;
+
+	up = nlmon_upgrade_create();
+	if (!up)
+		return -ENOMEM;
+	up->received = true;
+
+	ret = recv_header(conn, &hdr, up);
+
+	for (i = 0; ret == 0 && i < hdr.nsections; i++) {
+		ret = read_full(conn, &sh, sizeof(sh));
+		if (ret < 0)
+			break;
+		if (sh.len > NLMON_UPGRADE_MAX_SECTION || section_find(up, sh.type)) {
+			ret = -EPROTO;
+			break;
+		}
+
+		data = malloc(sh.len ? sh.len : 1);
+		if (!data) {
+			ret = -ENOMEM;
+			break;
+		}
+		ret = read_full(conn, data, sh.len);
+		if (ret == 0)
+			ret = section_append(up, sh.type, sh.record_size, data, sh.len);
+		if (ret < 0)
+			free(data);
+	}
+
+	if (ret < 0) {
+		nlmon_upgrade_destroy(up);
+		return ret;
+	}
+
+	*out = up;
+	return 0;
+}
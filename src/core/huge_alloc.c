@@ -0,0 +1,323 @@
+/* huge_alloc.c - Huge page backed allocation of large arrays
+ *
+ * Transparent huge pages only back 2MB aligned ranges, so those arrays
+ * are mapped with a huge page of slack and trimmed to start on a huge
+ * page boundary. Reserved huge pages are aligned by the kernel. Either
+ * way the length is rounded up to whole huge pages.
+ *
+ * Mapped arrays are kept in a list, looked up on free, which is rare
+ * for arrays this size. Arrays that came from calloc() are not in it.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "huge_alloc.h"
+#include "stats_bus.h"
+
+#define DEFAULT_HUGE_PAGE (2UL * 1024 * 1024)
+#define DEFAULT_MIN_SIZE DEFAULT_HUGE_PAGE
+
+struct huge_region {
+	struct huge_region *next;
+	void *ptr;
+	size_t size;
+	const char *owner;
+	enum huge_alloc_kind kind;
+	size_t thp_bytes;               /* Of the last smaps scan */
+};
+
+static struct huge_alloc_config config;
+static struct huge_region *regions;
+static pthread_mutex_t regions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Default huge page size of the system */
+static size_t huge_page;
+static pthread_once_t huge_page_once = PTHREAD_ONCE_INIT;
+
+static void huge_page_init(void)
+{
+	char line[128];
+	unsigned long kb;
+	FILE *fp;
+	
+	huge_page = DEFAULT_HUGE_PAGE;
+	fp = fopen("/proc/meminfo", "r");
+	if (!fp)
+		return;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1 && kb) {
+			huge_page = kb * 1024;
+			break;
+		}
+	}
+	fclose(fp);
+}
+
+void huge_alloc_configure(const struct huge_alloc_config *new_config)
+{
+	pthread_mutex_lock(&regions_lock);
+	if (new_config)
+		config = *new_config;
+	else
+		memset(&config, 0, sizeof(config));
+	pthread_mutex_unlock(&regions_lock);
+}
+
+/* Map from reserved huge pages, NULL if none are free */
+static void *map_hugetlb(size_t size)
+{
+#ifdef MAP_HUGETLB
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	
+	return ptr == MAP_FAILED ? NULL : ptr;
+#else
+	(void)size;
+	return NULL;
+#endif
+}
+
+/* Map huge page aligned ordinary memory, advised to be transparent huge pages */
+static void *map_thp(size_t size, enum huge_alloc_kind *kind)
+{
+	size_t span = size + huge_page;
+	uintptr_t start, aligned;
+	char *ptr;
+	
+	ptr = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED)
+		return NULL;
+	
+	/* Trim to a huge page boundary */
+	start = (uintptr_t)ptr;
+	aligned = (start + huge_page - 1) & ~(uintptr_t)(huge_page - 1);
+	if (aligned > start)
+		munmap(ptr, aligned - start);
+	if (start + span > aligned + size)
+		munmap((char *)aligned + size, start + span - aligned - size);
+	ptr = (char *)aligned;
+	
+	*kind = HUGE_KIND_PAGES;
+#ifdef MADV_HUGEPAGE
+	if (madvise(ptr, size, MADV_HUGEPAGE) == 0)
+		*kind = HUGE_KIND_THP;
+#endif
+	return ptr;
+}
+
+/* Fault a mapping in, one write per page */
+static void prefault(char *ptr, size_t size, size_t page)
+{
+#ifdef MADV_POPULATE_WRITE
+	if (madvise(ptr, size, MADV_POPULATE_WRITE) == 0)
+		return;
+#endif
+	for (size_t off = 0; off < size; off += page)
+		((volatile char *)ptr)[off] = 0;
+}
+
+void *huge_calloc(size_t nmemb, size_t size, unsigned int flags, const char *owner)
+{
+	struct huge_alloc_config cfg;
+	struct huge_region *region;
+	enum huge_alloc_kind kind = HUGE_KIND_HUGETLB;
+	size_t bytes, mapped;
+	void *ptr = NULL;
+	
+	if (size && nmemb > SIZE_MAX / size)
+		return NULL;
+	bytes = nmemb * size;
+	
+	pthread_mutex_lock(&regions_lock);
+	cfg = config;
+	pthread_mutex_unlock(&regions_lock);
+	
+	if (!(flags & HUGE_ALLOC_FORCE) &&
+	    (cfg.mode == HUGE_ALLOC_OFF || bytes < (cfg.min_size ? cfg.min_size : DEFAULT_MIN_SIZE)))
+		return calloc(nmemb, size);
+	
+	region = calloc(1, sizeof(*region));
+	if (!region)
+		return NULL;
+	
+	pthread_once(&huge_page_once, huge_page_init);
+	mapped = (bytes + huge_page - 1) & ~(huge_page - 1);
+	if (!mapped)
+		mapped = huge_page;
+	
+	/* Forced allocations with the backend off try both like HUGETLB */
+	if (cfg.mode != HUGE_ALLOC_THP)
+		ptr = map_hugetlb(mapped);
+	if (!ptr)
+		ptr = map_thp(mapped, &kind);
+	if (!ptr) {
+		free(region);
+		return calloc(nmemb, size);
+	}
+	
+	if (cfg.prefault)
+		prefault(ptr, mapped, kind == HUGE_KIND_HUGETLB ? huge_page : (size_t)getpagesize());
+	
+	region->ptr = ptr;
+	region->size = mapped;
+	region->owner = owner ? owner : "";
+	region->kind = kind;
+	
+	pthread_mutex_lock(&regions_lock);
+	region->next = regions;
+	regions = region;
+	pthread_mutex_unlock(&regions_lock);
+	
+	return ptr;
+}
+
+/* Region mapped at ptr, regions_lock held */
+static struct huge_region **region_find(const void *ptr)
+{
+	struct huge_region **link;
+	
+	for (link = &regions; *link; link = &(*link)->next) {
+		if ((*link)->ptr == ptr)
+			return link;
+	}
+	return NULL;
+}
+
+void huge_free(void *ptr)
+{
+	struct huge_region **link, *region = NULL;
+	
+	if (!ptr)
+		return;
+	
+	pthread_mutex_lock(&regions_lock);
+	link = region_find(ptr);
+	if (link) {
+		region = *link;
+		*link = region->next;
+	}
+	pthread_mutex_unlock(&regions_lock);
+	
+	if (!region) {
+		free(ptr);
+		return;
+	}
+	munmap(region->ptr, region->size);
+	free(region);
+}
+
+bool huge_alloc_backed(const void *ptr)
+{
+	struct huge_region **link;
+	bool backed;
+	
+	pthread_mutex_lock(&regions_lock);
+	link = region_find(ptr);
+	backed = link && (*link)->kind != HUGE_KIND_PAGES;
+	pthread_mutex_unlock(&regions_lock);
+	
+	return backed;
+}
+
+/* Update thp_bytes of the regions from /proc/self/smaps, regions_lock held */
+static void scan_thp(void)
+{
+	uintptr_t vma_start = 0, vma_end = 0;
+	struct huge_region *region;
+	bool any = false;
+	char line[256];
+	FILE *fp;
+	
+	for (region = regions; region; region = region->next) {
+		region->thp_bytes = 0;
+		any |= region->kind == HUGE_KIND_THP;
+	}
+	if (!any)
+		return;
+	
+	fp = fopen("/proc/self/smaps", "r");
+	if (!fp)
+		return;
+	
+	while (fgets(line, sizeof(line), fp)) {
+		unsigned long start, end, kb;
+	
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			vma_start = start;
+			vma_end = end;
+			continue;
+		}
+		if (sscanf(line, "AnonHugePages: %lu kB", &kb) != 1 || !kb)
+			continue;
+	
+		/* The kernel may have merged a region with its neighbours */
+		for (region = regions; region; region = region->next) {
+			uintptr_t start_r = (uintptr_t)region->ptr, end_r = start_r + region->size;
+			size_t overlap, bytes = kb * 1024;
+	
+			if (region->kind != HUGE_KIND_THP || end_r <= vma_start || start_r >= vma_end)
+				continue;
+			overlap = (end_r < vma_end ? end_r : vma_end) -
+			          (start_r > vma_start ? start_r : vma_start);
+			region->thp_bytes += bytes < overlap ? bytes : overlap;
+		}
+	}
+	fclose(fp);
+}
+
+void huge_alloc_get_stats(struct huge_alloc_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	
+	pthread_mutex_lock(&regions_lock);
+	scan_thp();
+	for (struct huge_region *region = regions; region; region = region->next) {
+		stats->regions++;
+		stats->bytes += region->size;
+		if (region->kind == HUGE_KIND_HUGETLB)
+			stats->hugetlb_bytes += region->size;
+		stats->thp_bytes += region->thp_bytes;
+	}
+	pthread_mutex_unlock(&regions_lock);
+}
+
+void huge_alloc_for_each(void (*fn)(const struct huge_alloc_region *region, void *ctx),
+                         void *ctx)
+{
+	struct huge_alloc_region info;
+	
+	if (!fn)
+		return;
+	
+	pthread_mutex_lock(&regions_lock);
+	scan_thp();
+	for (struct huge_region *region = regions; region; region = region->next) {
+		info.owner = region->owner;
+		info.size = region->size;
+		info.kind = region->kind;
+		info.huge_bytes = region->kind == HUGE_KIND_HUGETLB ? region->size : region->thp_bytes;
+		fn(&info, ctx);
+	}
+	pthread_mutex_unlock(&regions_lock);
+}
+
+void huge_alloc_collect_stats(struct nlmon_stats_snapshot *snapshot, void *ctx)
+{
+	struct huge_alloc_stats stats;
+	
+	(void)ctx;
+	huge_alloc_get_stats(&stats);
+	snapshot->hugepages.regions = stats.regions;
+	snapshot->hugepages.bytes = stats.bytes;
+	snapshot->hugepages.huge_bytes = stats.hugetlb_bytes + stats.thp_bytes;
+	snapshot->have |= STATS_HAVE_HUGEPAGES;
+}
@@ -0,0 +1,135 @@
+/* id_table.c - Growable hash table keyed by integer IDs */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "id_table.h"
+
+#define ID_TABLE_MIN_SIZE 64             /* Power of two */
+
+static uint64_t id_hash(uint64_t key)
+{
+	return key * 0x9E3779B97F4A7C15ULL;
+}
+
+/**
+ * Look up an entry
+ */
+void *id_table_find(const struct id_table *table, uint64_t key)
+{
+	size_t mask = table->size - 1;
+	size_t i;
+	
+	if (table->size == 0)
+		return NULL;
+	
+	for (i = id_hash(key) & mask; ; i = (i + 1) & mask) {
+		struct id_slot *slot = id_table_slot(table, i);
+		
+		if (!slot->used)
+			return NULL;
+		if (slot->key == key)
+			return slot;
+	}
+}
+
+/* Place an entry known not to be in the table */
+static struct id_slot *id_table_place(struct id_table *table, uint64_t key)
+{
+	size_t mask = table->size - 1;
+	size_t i = id_hash(key) & mask;
+	
+	while (id_table_slot(table, i)->used)
+		i = (i + 1) & mask;
+	
+	table->used++;
+	return id_table_slot(table, i);
+}
+
+static int id_table_grow(struct id_table *table)
+{
+	struct id_table bigger = *table;
+	size_t i;
+	
+	bigger.size = table->size ? table->size * 2 : ID_TABLE_MIN_SIZE;
+	bigger.used = 0;
+	bigger.slots = calloc(bigger.size, table->entry_size);
+	if (!bigger.slots)
+		return -1;
+	
+	for (i = 0; i < table->size; i++) {
+		struct id_slot *slot = id_table_slot(table, i);
+		
+		if (slot->used)
+			memcpy(id_table_place(&bigger, slot->key), slot, table->entry_size);
+	}
+	
+	free(table->slots);
+	*table = bigger;
+	return 0;
+}
+
+/**
+ * Look up an entry, adding it if it is new
+ */
+void *id_table_get(struct id_table *table, uint64_t key, int *created)
+{
+	struct id_slot *slot = id_table_find(table, key);
+	
+	*created = 0;
+	if (slot)
+		return slot;
+	
+	/* Keep the load at or below one half */
+	if ((table->used + 1) * 2 > table->size && id_table_grow(table) < 0)
+		return NULL;
+	
+	slot = id_table_place(table, key);
+	memset(slot, 0, table->entry_size);
+	slot->key = key;
+	slot->used = 1;
+	*created = 1;
+	return slot;
+}
+
+/**
+ * Remove an entry, shifting later entries of its probe run back into
+ * the hole so lookups never see tombstones
+ */
+void id_table_remove(struct id_table *table, void *entry)
+{
+	size_t mask = table->size - 1;
+	size_t i = ((char *)entry - table->slots) / table->entry_size;
+	size_t j = i;
+	
+	for (;;) {
+		struct id_slot *slot;
+		size_t home;
+		
+		j = (j + 1) & mask;
+		slot = id_table_slot(table, j);
+		if (!slot->used)
+			break;
+		
+		/* The entry at j may move to i unless its home lies in (i, j] */
+		home = id_hash(slot->key) & mask;
+		if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+			memcpy(id_table_slot(table, i), slot, table->entry_size);
+			i = j;
+		}
+	}
+	
+	id_table_slot(table, i)->used = 0;
+	table->used--;
+}
+
+/**
+ * Free all entries
+ */
+void id_table_free(struct id_table *table)
+{
+	free(table->slots);
+	table->slots = NULL;
+	table->size = 0;
+	table->used = 0;
+}
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 #include <net/if.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
@@ -11,31 +12,45 @@
 #include <linux/if_vlan.h>
 
 #include "interface_detector.h"
+#include "id_table.h"
 
-#define MAX_INTERFACES 1024
-
-/* Interface cache entry */
-struct iface_cache_entry {
-	int ifindex;
+/* Topology node. Children of an interface are the interfaces stacked
+ * on it, linked through their sibling fields by ifindex since table
+ * entries move. Index 0 means none. */
+struct iface_node {
+	struct id_slot slot;             /* Key is the interface index */
 	interface_type_t type;
 	char name[IFNAMSIZ];
-	int parent_ifindex;
-	int valid;
+	int master;                      /* IFLA_MASTER */
+	int link;                        /* IFLA_LINK of stacked devices */
+	int parent;                      /* master, else link */
+	uint16_t vlan_id;
+	int first_child;
+	int next_sibling;
+	int prev_sibling;
+	unsigned int num_children;
+	int seen;                        /* Reported by RTM_NEWLINK, not only a parent */
 };
 
 struct interface_detector {
-	struct iface_cache_entry cache[MAX_INTERFACES];
-	int cache_count;
+	struct id_table nodes;           /* struct iface_node by ifindex */
+	pthread_rwlock_t lock;           /* Queries come from filter, CLI and web threads */
 };
 
 struct interface_detector *interface_detector_init(void)
 {
 	struct interface_detector *detector;
-
+	
 	detector = calloc(1, sizeof(*detector));
 	if (!detector)
 		return NULL;
-
+	
+	detector->nodes = (struct id_table)ID_TABLE_INIT(struct iface_node);
+	if (pthread_rwlock_init(&detector->lock, NULL) != 0) {
+		free(detector);
+		return NULL;
+	}
+	
 	return detector;
 }
 
@@ -44,7 +59,7 @@ static interface_type_t get_type_from_kind(const char *kind)
 {
 	if (!kind)
 		return IFACE_TYPE_UNKNOWN;
-
+	
 	if (strcmp(kind, "veth") == 0)
 		return IFACE_TYPE_VETH;
 	else if (strcmp(kind, "bridge") == 0)
@@ -63,7 +78,7 @@ static interface_type_t get_type_from_kind(const char *kind)
 		return IFACE_TYPE_MACVLAN;
 	else if (strcmp(kind, "ipvlan") == 0)
 		return IFACE_TYPE_IPVLAN;
-
+	
 	return IFACE_TYPE_UNKNOWN;
 }
 
@@ -74,32 +89,32 @@ interface_type_t interface_detector_detect_type(struct interface_detector *detec
 	struct rtattr *rta;
 	int rtalen;
 	interface_type_t type = IFACE_TYPE_UNKNOWN;
-
+	
 	if (!detector || !nlh)
 		return IFACE_TYPE_UNKNOWN;
-
+	
 	if (nlh->nlmsg_type != RTM_NEWLINK && nlh->nlmsg_type != RTM_DELLINK &&
 	    nlh->nlmsg_type != RTM_GETLINK && nlh->nlmsg_type != RTM_SETLINK)
 		return IFACE_TYPE_UNKNOWN;
-
+	
 	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
 		return IFACE_TYPE_UNKNOWN;
-
+	
 	ifi = (struct ifinfomsg *)NLMSG_DATA(nlh);
-
+	
 	/* Check for loopback */
 	if (ifi->ifi_flags & IFF_LOOPBACK)
 		return IFACE_TYPE_LOOPBACK;
-
+	
 	/* Parse attributes to find IFLA_LINKINFO */
 	rta = IFLA_RTA(ifi);
 	rtalen = IFLA_PAYLOAD(nlh);
-
+	
 	while (RTA_OK(rta, rtalen)) {
 		if (rta->rta_type == IFLA_LINKINFO) {
 			struct rtattr *linkinfo = RTA_DATA(rta);
 			int linkinfo_len = RTA_PAYLOAD(rta);
-
+			
 			/* Parse IFLA_LINKINFO attributes */
 			while (RTA_OK(linkinfo, linkinfo_len)) {
 				if (linkinfo->rta_type == IFLA_INFO_KIND) {
@@ -109,18 +124,18 @@ interface_type_t interface_detector_detect_type(struct interface_detector *detec
 				}
 				linkinfo = RTA_NEXT(linkinfo, linkinfo_len);
 			}
-
+			
 			if (type != IFACE_TYPE_UNKNOWN)
 				break;
 		}
-
+		
 		rta = RTA_NEXT(rta, rtalen);
 	}
-
+	
 	/* Default to ethernet if no specific type found */
 	if (type == IFACE_TYPE_UNKNOWN && !(ifi->ifi_flags & IFF_LOOPBACK))
 		type = IFACE_TYPE_ETHERNET;
-
+	
 	return type;
 }
 
@@ -131,49 +146,49 @@ int interface_detector_parse_info(struct interface_detector *detector,
 	struct ifinfomsg *ifi;
 	struct rtattr *rta;
 	int rtalen;
-
+	
 	if (!detector || !nlh || !info)
 		return -1;
-
+	
 	if (nlh->nlmsg_type != RTM_NEWLINK && nlh->nlmsg_type != RTM_DELLINK &&
 	    nlh->nlmsg_type != RTM_GETLINK && nlh->nlmsg_type != RTM_SETLINK)
 		return -1;
-
+	
 	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
 		return -1;
-
+	
 	ifi = (struct ifinfomsg *)NLMSG_DATA(nlh);
-
+	
 	memset(info, 0, sizeof(*info));
 	info->ifindex = ifi->ifi_index;
 	info->flags = ifi->ifi_flags;
 	info->type = interface_detector_detect_type(detector, nlh);
-
+	
 	/* Parse attributes */
 	rta = IFLA_RTA(ifi);
 	rtalen = IFLA_PAYLOAD(nlh);
-
+	
 	while (RTA_OK(rta, rtalen)) {
 		switch (rta->rta_type) {
 		case IFLA_IFNAME:
 			strncpy(info->name, (char *)RTA_DATA(rta), IFNAMSIZ - 1);
 			info->name[IFNAMSIZ - 1] = '\0';
 			break;
-
+			
 		case IFLA_ADDRESS:
 			if (RTA_PAYLOAD(rta) == 6) {
 				memcpy(info->mac_addr, RTA_DATA(rta), 6);
 			}
 			break;
-
+			
 		case IFLA_MTU:
 			info->mtu = *(int *)RTA_DATA(rta);
 			break;
 		}
-
+		
 		rta = RTA_NEXT(rta, rtalen);
 	}
-
+	
 	/* Parse type-specific info */
 	switch (info->type) {
 	case IFACE_TYPE_BRIDGE:
@@ -188,7 +203,7 @@ int interface_detector_parse_info(struct interface_detector *detector,
 	default:
 		break;
 	}
-
+	
 	return 0;
 }
 
@@ -199,38 +214,38 @@ int interface_detector_parse_bridge(struct interface_detector *detector,
 	struct ifinfomsg *ifi;
 	struct rtattr *rta;
 	int rtalen;
-
+	
 	if (!detector || !nlh || !bridge)
 		return -1;
-
+	
 	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
 		return -1;
-
+	
 	ifi = (struct ifinfomsg *)NLMSG_DATA(nlh);
-
+	
 	memset(bridge, 0, sizeof(*bridge));
 	bridge->ifindex = ifi->ifi_index;
-
+	
 	/* Parse attributes */
 	rta = IFLA_RTA(ifi);
 	rtalen = IFLA_PAYLOAD(nlh);
-
+	
 	while (RTA_OK(rta, rtalen)) {
 		switch (rta->rta_type) {
 		case IFLA_IFNAME:
 			strncpy(bridge->name, (char *)RTA_DATA(rta), IFNAMSIZ - 1);
 			bridge->name[IFNAMSIZ - 1] = '\0';
 			break;
-
+			
 		case IFLA_LINKINFO: {
 			struct rtattr *linkinfo = RTA_DATA(rta);
 			int linkinfo_len = RTA_PAYLOAD(rta);
-
+				
 			while (RTA_OK(linkinfo, linkinfo_len)) {
 				if (linkinfo->rta_type == IFLA_INFO_DATA) {
 					struct rtattr *data = RTA_DATA(linkinfo);
 					int data_len = RTA_PAYLOAD(linkinfo);
-
+						
 					/* Parse bridge-specific attributes */
 					while (RTA_OK(data, data_len)) {
 						switch (data->rta_type) {
@@ -257,16 +272,21 @@ int interface_detector_parse_bridge(struct interface_detector *detector,
 			}
 			break;
 		}
-
-		case IFLA_MASTER:
-			/* This interface is a slave of a bridge */
-			/* We'd need to track this separately */
-			break;
+			
 		}
-
+		
 		rta = RTA_NEXT(rta, rtalen);
 	}
-
+	
+	/* Ports are the interfaces enslaved to it, as last reported */
+	bridge->num_ports = interface_detector_get_members(detector, bridge->ifindex,
+	                                                   bridge->port_ifindices, 256);
+	if (bridge->num_ports < 0)
+		bridge->num_ports = 0;
+	for (int i = 0; i < bridge->num_ports; i++)
+		interface_detector_get_name(detector, bridge->port_ifindices[i],
+		                            bridge->port_names[i], IFNAMSIZ);
+	
 	return 0;
 }
 
@@ -277,23 +297,23 @@ int interface_detector_parse_vlan(struct interface_detector *detector,
 	struct ifinfomsg *ifi;
 	struct rtattr *rta;
 	int rtalen;
-
+	
 	if (!detector || !nlh || !vlan)
 		return -1;
-
+	
 	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
 		return -1;
-
+	
 	ifi = (struct ifinfomsg *)NLMSG_DATA(nlh);
-
+	
 	memset(vlan, 0, sizeof(*vlan));
 	vlan->ifindex = ifi->ifi_index;
 	vlan->protocol = 0x8100;  /* Default to 802.1Q */
-
+	
 	/* Parse attributes */
 	rta = IFLA_RTA(ifi);
 	rtalen = IFLA_PAYLOAD(nlh);
-
+	
 	while (RTA_OK(rta, rtalen)) {
 		switch (rta->rta_type) {
 		case IFLA_IFNAME:
@@ -303,18 +323,20 @@ int interface_detector_parse_vlan(struct interface_detector *detector,
 			
 		case IFLA_LINK:
 			vlan->parent_ifindex = *(int *)RTA_DATA(rta);
-			if_indextoname(vlan->parent_ifindex, vlan->parent_name);
+			if (interface_detector_get_name(detector, vlan->parent_ifindex,
+			                                vlan->parent_name, IFNAMSIZ) < 0)
+				if_indextoname(vlan->parent_ifindex, vlan->parent_name);
 			break;
 			
 		case IFLA_LINKINFO: {
 			struct rtattr *linkinfo = RTA_DATA(rta);
 			int linkinfo_len = RTA_PAYLOAD(rta);
-			
+				
 			while (RTA_OK(linkinfo, linkinfo_len)) {
 				if (linkinfo->rta_type == IFLA_INFO_DATA) {
 					struct rtattr *data = RTA_DATA(linkinfo);
 					int data_len = RTA_PAYLOAD(linkinfo);
-					
+						
 					/* Parse VLAN-specific attributes */
 					while (RTA_OK(data, data_len)) {
 						switch (data->rta_type) {
@@ -373,12 +395,12 @@ int interface_detector_parse_bond(struct interface_detector *detector,
 		case IFLA_LINKINFO: {
 			struct rtattr *linkinfo = RTA_DATA(rta);
 			int linkinfo_len = RTA_PAYLOAD(rta);
-			
+				
 			while (RTA_OK(linkinfo, linkinfo_len)) {
 				if (linkinfo->rta_type == IFLA_INFO_DATA) {
 					struct rtattr *data = RTA_DATA(linkinfo);
 					int data_len = RTA_PAYLOAD(linkinfo);
-					
+						
 					/* Parse bond-specific attributes */
 					while (RTA_OK(data, data_len)) {
 						switch (data->rta_type) {
@@ -398,16 +420,395 @@ int interface_detector_parse_bond(struct interface_detector *detector,
 		rta = RTA_NEXT(rta, rtalen);
 	}
 	
+	/* Slaves are the interfaces enslaved to it, as last reported */
+	bond->num_slaves = interface_detector_get_members(detector, bond->ifindex,
+	                                                  bond->slave_ifindices, 32);
+	if (bond->num_slaves < 0)
+		bond->num_slaves = 0;
+	for (int i = 0; i < bond->num_slaves; i++)
+		interface_detector_get_name(detector, bond->slave_ifindices[i],
+		                            bond->slave_names[i], IFNAMSIZ);
+	
+	return 0;
+}
+
+/* Devices whose IFLA_LINK is the device they are stacked on, rather
+ * than a peer such as the other end of a veth pair */
+static int is_stacked_type(interface_type_t type)
+{
+	return type == IFACE_TYPE_VLAN || type == IFACE_TYPE_MACVLAN ||
+	       type == IFACE_TYPE_IPVLAN;
+}
+
+/* Whether ancestor is ifindex or above it, bounded against loops left
+ * by events seen out of order */
+static int node_is_under(struct interface_detector *detector, int ifindex, int ancestor)
+{
+	struct iface_node *node;
+	int depth;
+	
+	for (depth = 0; ifindex > 0 && depth <= INTERFACE_MAX_DEPTH; depth++) {
+		if (ifindex == ancestor)
+			return 1;
+		node = id_table_find(&detector->nodes, (uint64_t)ifindex);
+		if (!node)
+			return 0;
+		ifindex = node->parent;
+	}
+	
+	return 0;
+}
+
+/* Take a node off its parent's child list, dropping a parent that was
+ * only known as a parent once it has no children left */
+static void node_unlink(struct interface_detector *detector, int ifindex)
+{
+	struct iface_node *node, *parent, *sibling;
+	int parent_ifindex;
+	
+	node = id_table_find(&detector->nodes, (uint64_t)ifindex);
+	if (!node || !node->parent)
+		return;
+	
+	parent_ifindex = node->parent;
+	parent = id_table_find(&detector->nodes, (uint64_t)parent_ifindex);
+	
+	if (node->prev_sibling) {
+		sibling = id_table_find(&detector->nodes, (uint64_t)node->prev_sibling);
+		if (sibling)
+			sibling->next_sibling = node->next_sibling;
+	} else if (parent) {
+		parent->first_child = node->next_sibling;
+	}
+	if (node->next_sibling) {
+		sibling = id_table_find(&detector->nodes, (uint64_t)node->next_sibling);
+		if (sibling)
+			sibling->prev_sibling = node->prev_sibling;
+	}
+	
+	node->parent = 0;
+	node->next_sibling = 0;
+	node->prev_sibling = 0;
+	
+	if (parent) {
+		parent->num_children--;
+		if (!parent->seen && parent->num_children == 0)
+			id_table_remove(&detector->nodes, parent);
+	}
+}
+
+/* Put a node at the head of a parent's child list */
+static int node_link(struct interface_detector *detector, int ifindex, int parent_ifindex)
+{
+	struct iface_node *node, *parent, *sibling;
+	int created;
+	
+	if (node_is_under(detector, parent_ifindex, ifindex))
+		return -1;
+	
+	/* Adding the parent may move the node, look it up afterwards */
+	parent = id_table_get(&detector->nodes, (uint64_t)parent_ifindex, &created);
+	if (!parent)
+		return -1;
+	node = id_table_find(&detector->nodes, (uint64_t)ifindex);
+	if (!node)
+		return -1;
+	
+	if (parent->first_child) {
+		sibling = id_table_find(&detector->nodes, (uint64_t)parent->first_child);
+		if (sibling)
+			sibling->prev_sibling = ifindex;
+	}
+	node->next_sibling = parent->first_child;
+	node->prev_sibling = 0;
+	node->parent = parent_ifindex;
+	parent->first_child = ifindex;
+	parent->num_children++;
+	
+	return 0;
+}
+
+/* Everything RTM_NEWLINK tells about a node, in one attribute pass */
+static void parse_node(struct nlmsghdr *nlh, struct iface_node *node)
+{
+	struct ifinfomsg *ifi = (struct ifinfomsg *)NLMSG_DATA(nlh);
+	struct rtattr *rta = IFLA_RTA(ifi);
+	int rtalen = IFLA_PAYLOAD(nlh);
+	struct rtattr *vlan_data = NULL;
+	
+	node->type = IFACE_TYPE_UNKNOWN;
+	node->master = 0;
+	node->link = 0;
+	node->vlan_id = 0;
+	
+	while (RTA_OK(rta, rtalen)) {
+		switch (rta->rta_type) {
+		case IFLA_IFNAME:
+			snprintf(node->name, sizeof(node->name), "%.*s",
+			         (int)RTA_PAYLOAD(rta), (char *)RTA_DATA(rta));
+			break;
+			
+		case IFLA_MASTER:
+			if (RTA_PAYLOAD(rta) >= sizeof(int))
+				node->master = *(int *)RTA_DATA(rta);
+			break;
+			
+		case IFLA_LINK:
+			if (RTA_PAYLOAD(rta) >= sizeof(int))
+				node->link = *(int *)RTA_DATA(rta);
+			break;
+			
+		case IFLA_LINKINFO: {
+			struct rtattr *linkinfo = RTA_DATA(rta);
+			int linkinfo_len = RTA_PAYLOAD(rta);
+				
+			while (RTA_OK(linkinfo, linkinfo_len)) {
+				if (linkinfo->rta_type == IFLA_INFO_KIND)
+					node->type = get_type_from_kind((const char *)RTA_DATA(linkinfo));
+				else if (linkinfo->rta_type == IFLA_INFO_DATA)
+					vlan_data = linkinfo;
+				linkinfo = RTA_NEXT(linkinfo, linkinfo_len);
+			}
+			break;
+		}
+		}
+		
+		rta = RTA_NEXT(rta, rtalen);
+	}
+	
+	if (ifi->ifi_flags & IFF_LOOPBACK)
+		node->type = IFACE_TYPE_LOOPBACK;
+	else if (node->type == IFACE_TYPE_UNKNOWN)
+		node->type = IFACE_TYPE_ETHERNET;
+	
+	if (node->type == IFACE_TYPE_VLAN && vlan_data) {
+		struct rtattr *data = RTA_DATA(vlan_data);
+		int data_len = RTA_PAYLOAD(vlan_data);
+		
+		while (RTA_OK(data, data_len)) {
+			if (data->rta_type == IFLA_VLAN_ID && RTA_PAYLOAD(data) >= sizeof(uint16_t))
+				node->vlan_id = *(uint16_t *)RTA_DATA(data);
+			data = RTA_NEXT(data, data_len);
+		}
+	}
+}
+
+static void node_remove(struct interface_detector *detector, int ifindex)
+{
+	struct iface_node *node, *child;
+	int next;
+	
+	node = id_table_find(&detector->nodes, (uint64_t)ifindex);
+	if (!node)
+		return;
+	
+	/* Orphan the children, the kernel reports their new place */
+	for (next = node->first_child; next; ) {
+		child = id_table_find(&detector->nodes, (uint64_t)next);
+		if (!child)
+			break;
+		next = child->next_sibling;
+		child->parent = 0;
+		child->next_sibling = 0;
+		child->prev_sibling = 0;
+	}
+	node->first_child = 0;
+	node->num_children = 0;
+	node->seen = 0;
+	
+	/* Holds on to the node of a parent only it kept */
+	node_unlink(detector, ifindex);
+	
+	node = id_table_find(&detector->nodes, (uint64_t)ifindex);
+	if (node)
+		id_table_remove(&detector->nodes, node);
+}
+
+int interface_detector_update(struct interface_detector *detector,
+                              struct nlmsghdr *nlh)
+{
+	struct ifinfomsg *ifi;
+	struct iface_node parsed, *node;
+	int ifindex, parent;
+	int created;
+	
+	if (!detector || !nlh)
+		return -1;
+	
+	if (nlh->nlmsg_type != RTM_NEWLINK && nlh->nlmsg_type != RTM_DELLINK)
+		return 0;
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+		return -1;
+	
+	ifi = (struct ifinfomsg *)NLMSG_DATA(nlh);
+	ifindex = ifi->ifi_index;
+	if (ifindex <= 0)
+		return -1;
+	
+	pthread_rwlock_wrlock(&detector->lock);
+	
+	if (nlh->nlmsg_type == RTM_DELLINK) {
+		node_remove(detector, ifindex);
+		pthread_rwlock_unlock(&detector->lock);
+		return 1;
+	}
+	
+	memset(&parsed, 0, sizeof(parsed));
+	parse_node(nlh, &parsed);
+	if (parsed.master)
+		parent = parsed.master;
+	else if (is_stacked_type(parsed.type) && parsed.link != ifindex)
+		parent = parsed.link;
+	else
+		parent = 0;
+	
+	node = id_table_get(&detector->nodes, (uint64_t)ifindex, &created);
+	if (!node) {
+		pthread_rwlock_unlock(&detector->lock);
+		return -1;
+	}
+	node->type = parsed.type;
+	if (parsed.name[0])
+		memcpy(node->name, parsed.name, sizeof(node->name));
+	node->master = parsed.master;
+	node->link = parsed.link;
+	node->vlan_id = parsed.vlan_id;
+	node->seen = 1;
+	
+	if (node->parent != parent) {
+		node_unlink(detector, ifindex);
+		if (parent > 0)
+			node_link(detector, ifindex, parent);
+	}
+	
+	pthread_rwlock_unlock(&detector->lock);
+	return 1;
+}
+
+int interface_detector_get_link(struct interface_detector *detector, int ifindex,
+                                struct interface_link *link)
+{
+	struct iface_node *node;
+	
+	if (!detector || !link)
+		return -1;
+	
+	pthread_rwlock_rdlock(&detector->lock);
+	node = id_table_find(&detector->nodes, (uint64_t)ifindex);
+	if (!node || !node->seen) {
+		pthread_rwlock_unlock(&detector->lock);
+		return -1;
+	}
+	
+	memset(link, 0, sizeof(*link));
+	link->ifindex = ifindex;
+	link->type = node->type;
+	memcpy(link->name, node->name, sizeof(link->name));
+	link->master = node->master;
+	link->link = node->link;
+	link->parent = node->parent;
+	link->vlan_id = node->vlan_id;
+	link->num_children = node->num_children;
+	pthread_rwlock_unlock(&detector->lock);
+	
 	return 0;
 }
 
+int interface_detector_get_name(struct interface_detector *detector, int ifindex,
+                                char *name, size_t len)
+{
+	struct iface_node *node;
+	int ret = -1;
+	
+	if (!detector || !name || len == 0)
+		return -1;
+	
+	pthread_rwlock_rdlock(&detector->lock);
+	node = id_table_find(&detector->nodes, (uint64_t)ifindex);
+	if (node && node->seen && node->name[0]) {
+		snprintf(name, len, "%s", node->name);
+		ret = 0;
+	}
+	pthread_rwlock_unlock(&detector->lock);
+	
+	return ret;
+}
+
+int interface_detector_get_ancestors(struct interface_detector *detector, int ifindex,
+                                     int *ancestors, int max_ancestors)
+{
+	struct iface_node *node;
+	int depth = 0;
+	
+	if (!detector)
+		return -1;
+	
+	pthread_rwlock_rdlock(&detector->lock);
+	node = id_table_find(&detector->nodes, (uint64_t)ifindex);
+	while (node && node->parent && depth < INTERFACE_MAX_DEPTH) {
+		if (ancestors && depth < max_ancestors)
+			ancestors[depth] = node->parent;
+		depth++;
+		node = id_table_find(&detector->nodes, (uint64_t)node->parent);
+	}
+	pthread_rwlock_unlock(&detector->lock);
+	
+	return depth;
+}
+
+int interface_detector_get_members(struct interface_detector *detector, int master,
+                                   int *members, int max_members)
+{
+	struct iface_node *node, *child;
+	int count = 0;
+	int next;
+	
+	if (!detector)
+		return -1;
+	
+	pthread_rwlock_rdlock(&detector->lock);
+	node = id_table_find(&detector->nodes, (uint64_t)master);
+	for (next = node ? node->first_child : 0; next && count < max_members; next = child->next_sibling) {
+		child = id_table_find(&detector->nodes, (uint64_t)next);
+		if (!child)
+			break;
+		
+		/* Skip devices stacked on the master, such as its VLANs */
+		if (child->master != master)
+			continue;
+		if (members)
+			members[count] = next;
+		count++;
+	}
+	pthread_rwlock_unlock(&detector->lock);
+	
+	return count;
+}
+
+int interface_detector_is_under(struct interface_detector *detector, int ifindex,
+                                int ancestor)
+{
+	int ret;
+	
+	if (!detector || ifindex <= 0 || ancestor <= 0)
+		return 0;
+	
+	pthread_rwlock_rdlock(&detector->lock);
+	ret = ifindex != ancestor && node_is_under(detector, ifindex, ancestor);
+	pthread_rwlock_unlock(&detector->lock);
+	
+	return ret;
+}
+
 int interface_detector_get_hierarchy(struct interface_detector *detector,
                                      int ifindex,
                                      int *parent_ifindex,
                                      int *child_ifindices,
                                      int max_children)
 {
-	int i, child_count = 0;
+	struct iface_node *node;
+	int child_count = 0;
+	int next;
 	
 	if (!detector)
 		return -1;
@@ -415,24 +816,28 @@ int interface_detector_get_hierarchy(struct interface_detector *detector,
 	if (parent_ifindex)
 		*parent_ifindex = -1;
 	
-	/* Search cache for parent and children */
-	for (i = 0; i < detector->cache_count; i++) {
-		if (!detector->cache[i].valid)
-			continue;
-		
-		/* Check if this is the interface we're looking for */
-		if (detector->cache[i].ifindex == ifindex) {
-			if (parent_ifindex)
-				*parent_ifindex = detector->cache[i].parent_ifindex;
-		}
+	pthread_rwlock_rdlock(&detector->lock);
+	node = id_table_find(&detector->nodes, (uint64_t)ifindex);
+	if (!node) {
+		pthread_rwlock_unlock(&detector->lock);
+		return 0;
+	}
+	
+	if (parent_ifindex && node->seen)
+		*parent_ifindex = node->parent;
+	
+	/* Walk the child list */
+	for (next = node->first_child; next && child_count < max_children; ) {
+		struct iface_node *child = id_table_find(&detector->nodes, (uint64_t)next);
 		
-		/* Check if this is a child of our interface */
-		if (detector->cache[i].parent_ifindex == ifindex) {
-			if (child_ifindices && child_count < max_children) {
-				child_ifindices[child_count++] = detector->cache[i].ifindex;
-			}
-		}
+		if (!child)
+			break;
+		if (child_ifindices)
+			child_ifindices[child_count] = next;
+		child_count++;
+		next = child->next_sibling;
 	}
+	pthread_rwlock_unlock(&detector->lock);
 	
 	return child_count;
 }
@@ -472,5 +877,7 @@ void interface_detector_destroy(struct interface_detector *detector)
 	if (!detector)
 		return;
 	
+	id_table_free(&detector->nodes);
+	pthread_rwlock_destroy(&detector->lock);
 	free(detector);
 }
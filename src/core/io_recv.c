@@ -0,0 +1,559 @@
+/* io_recv.c - Multishot socket receive through io_uring
+ *
+ * Each source owns buffer group <source number>, a ring of buffers the
+ * kernel consumes in order and we refill one buffer at a time as its
+ * datagram has been handled. Giving every socket its own group keeps a
+ * burst on one socket from starving the others of buffers.
+ *
+ * A source's receive is tagged with a generation in the user data, and
+ * io_recv_set_fd() moves to a new generation, so completions still
+ * arriving for a cancelled receive are recognised and only their
+ * buffers recycled.
+ *
+ * The kernel ends a multishot receive with -ENOBUFS both when the socket
+ * reported an overrun and when the source's buffer ring ran dry. Only
+ * the first loses datagrams, and it shows in the socket's drop counter,
+ * so a dry ring with no new drops is re-armed without telling the
+ * handler. The wakeup eventfd is read with a plain read that
+ * is re-armed every time it completes.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <linux/sock_diag.h>
+#include "io_ring.h"
+#include "io_recv.h"
+#include "nlmon_nl_msgpool.h"
+
+/* User data of the wakeup read, and of requests whose completion is ignored */
+#define IO_RECV_WAKE_DATA 0ULL
+#define IO_RECV_IGNORE_DATA UINT64_MAX
+
+/* Largest provided buffer ring */
+#define IO_RECV_MAX_BUFFERS 32768
+
+/* Submission queue, an arm and a cancel per source and the wakeup read */
+#define IO_RECV_SQ_ENTRIES 32
+
+struct io_recv_source {
+	int fd;
+	uint32_t generation;
+	bool armed;
+	uint32_t drops;                   /* Socket drop counter when last looked at */
+	io_recv_fn fn;
+	void *ctx;
+	struct msghdr msg;                /* Name space reserved in every buffer */
+	
+	struct io_uring_buf_ring *br;
+	size_t br_size;
+	void **bufs;
+	uint16_t tail;
+};
+
+struct io_recv {
+	struct io_ring ring;
+	unsigned int sq_tail;             /* Local submission tail */
+	unsigned int to_submit;
+	
+	struct io_recv_source sources[IO_RECV_MAX_SOURCES];
+	unsigned int source_count;
+	unsigned int buffer_count;
+	size_t buffer_size;
+	struct nlmon_nl_msgpool *pool;
+	bool own_pool;
+	
+	int wake_fd;
+	uint64_t wake_value;
+	
+	/* Statistics */
+	atomic_ulong datagrams;
+	atomic_ulong bytes;
+	atomic_ulong truncated;
+	atomic_ulong errors;
+	atomic_ulong rearms;
+	atomic_ulong exhausted;
+	atomic_ulong batches;
+};
+
+static uint64_t source_data(struct io_recv *rx, struct io_recv_source *src)
+{
+	return ((uint64_t)src->generation << 32) | (uint64_t)(src - rx->sources + 1);
+}
+
+/* Queue an SQE, submitting the queue first when it is full */
+static struct io_uring_sqe *queue_sqe(struct io_recv *rx)
+{
+	if (rx->to_submit >= IO_RECV_SQ_ENTRIES) {
+		io_ring_submit(&rx->ring, rx->sq_tail, rx->to_submit);
+		rx->to_submit = 0;
+	}
+	
+	rx->to_submit++;
+	return io_ring_sqe(&rx->ring, &rx->sq_tail);
+}
+
+static void arm_wake(struct io_recv *rx)
+{
+	struct io_uring_sqe *sqe = queue_sqe(rx);
+	
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = rx->wake_fd;
+	sqe->addr = (uint64_t)(uintptr_t)&rx->wake_value;
+	sqe->len = sizeof(rx->wake_value);
+	sqe->user_data = IO_RECV_WAKE_DATA;
+}
+
+static void arm_source(struct io_recv *rx, struct io_recv_source *src)
+{
+	struct io_uring_sqe *sqe = queue_sqe(rx);
+	
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = src->fd;
+	sqe->addr = (uint64_t)(uintptr_t)&src->msg;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = (uint16_t)(src - rx->sources);
+	sqe->user_data = source_data(rx, src);
+	src->armed = true;
+}
+
+static void cancel_source(struct io_recv *rx, struct io_recv_source *src)
+{
+	struct io_uring_sqe *sqe = queue_sqe(rx);
+	
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = source_data(rx, src);
+	sqe->user_data = IO_RECV_IGNORE_DATA;
+}
+
+/* Hand a buffer back to the kernel */
+static void recycle(struct io_recv *rx, struct io_recv_source *src, unsigned int bid)
+{
+	struct io_uring_buf *buf = &src->br->bufs[src->tail & (rx->buffer_count - 1)];
+	
+	buf->addr = (uint64_t)(uintptr_t)src->bufs[bid];
+	buf->len = (uint32_t)rx->buffer_size;
+	buf->bid = (uint16_t)bid;
+	src->tail++;
+	atomic_store_explicit((_Atomic uint16_t *)&src->br->tail, src->tail,
+	                      memory_order_release);
+}
+
+/* Whether the socket dropped datagrams since the last call, true if unknown */
+static bool source_dropped(struct io_recv_source *src)
+{
+	uint32_t meminfo[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(meminfo);
+	uint32_t drops;
+	
+	if (getsockopt(src->fd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) < 0 ||
+	    len <= SK_MEMINFO_DROPS * sizeof(uint32_t))
+		return true;
+	
+	drops = meminfo[SK_MEMINFO_DROPS];
+	if (drops == src->drops)
+		return false;
+	src->drops = drops;
+	return true;
+}
+
+/* Errors after which receiving the same socket again makes sense */
+static bool error_transient(int error)
+{
+	return error == -ENOBUFS || error == -EAGAIN || error == -EINTR;
+}
+
+static void deliver(struct io_recv *rx, struct io_recv_source *src, unsigned int bid, int res)
+{
+	struct io_uring_recvmsg_out *out = src->bufs[bid];
+	size_t header = sizeof(*out) + src->msg.msg_namelen;
+	struct io_recv_msg msg;
+	
+	if ((size_t)res < header)
+		return;
+	
+	memset(&msg, 0, sizeof(msg));
+	msg.data = (char *)out + header;
+	msg.len = (size_t)res - header;
+	msg.truncated = (out->flags & MSG_TRUNC) != 0;
+	if (src->msg.msg_namelen && out->namelen) {
+		msg.name = out + 1;
+		msg.namelen = out->namelen < src->msg.msg_namelen ? out->namelen :
+		              src->msg.msg_namelen;
+	}
+	
+	atomic_fetch_add_explicit(&rx->datagrams, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&rx->bytes, msg.len, memory_order_relaxed);
+	if (msg.truncated)
+		atomic_fetch_add_explicit(&rx->truncated, 1, memory_order_relaxed);
+	
+	src->fn(src->ctx, (int)(src - rx->sources), &msg, 0);
+}
+
+static void complete(struct io_recv *rx, struct io_uring_cqe *cqe)
+{
+	unsigned int index = (unsigned int)(cqe->user_data & UINT32_MAX) - 1;
+	uint32_t generation = (uint32_t)(cqe->user_data >> 32);
+	bool buffer = (cqe->flags & IORING_CQE_F_BUFFER) != 0;
+	unsigned int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	struct io_recv_source *src;
+	
+	if (index >= rx->source_count)
+		return;
+	src = &rx->sources[index];
+	
+	/* Left over from a socket we moved away from */
+	if (generation != src->generation) {
+		if (buffer)
+			recycle(rx, src, bid);
+		return;
+	}
+	
+	if (!(cqe->flags & IORING_CQE_F_MORE))
+		src->armed = false;
+	
+	if (buffer) {
+		if (cqe->res > 0)
+			deliver(rx, src, bid, cqe->res);
+		recycle(rx, src, bid);
+	} else if (cqe->res == -ENOBUFS && !source_dropped(src)) {
+		atomic_fetch_add_explicit(&rx->exhausted, 1, memory_order_relaxed);
+	} else if (cqe->res < 0 && cqe->res != -ECANCELED) {
+		atomic_fetch_add_explicit(&rx->errors, 1, memory_order_relaxed);
+		src->fn(src->ctx, (int)index, NULL, cqe->res);
+	}
+	
+	/* The handler may have moved the source already */
+	if (src->armed || generation != src->generation || src->fd < 0)
+		return;
+	
+	if (cqe->res >= 0 || error_transient(cqe->res)) {
+		atomic_fetch_add_explicit(&rx->rearms, 1, memory_order_relaxed);
+		arm_source(rx, src);
+	}
+}
+
+int io_recv_run(struct io_recv *rx, bool wait)
+{
+	struct io_ring *ring;
+	unsigned int head, tail;
+	int handled = 0;
+	int ret;
+	
+	if (!rx)
+		return -EINVAL;
+	ring = &rx->ring;
+	
+	/* Also flushes completions the kernel holds back on overflow */
+	atomic_store_explicit(ring->sq_tail, rx->sq_tail, memory_order_release);
+	ret = io_ring_enter(ring, rx->to_submit, wait ? 1 : 0, IORING_ENTER_GETEVENTS);
+	if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		return -errno;
+	if (ret > 0)
+		rx->to_submit -= (unsigned int)ret < rx->to_submit ? (unsigned int)ret : rx->to_submit;
+	
+	head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+	tail = atomic_load_explicit(ring->cq_tail, memory_order_acquire);
+	while (head != tail) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+		
+		if (cqe->user_data == IO_RECV_WAKE_DATA) {
+			arm_wake(rx);
+		} else if (cqe->user_data != IO_RECV_IGNORE_DATA) {
+			complete(rx, cqe);
+			handled++;
+		}
+		
+		head++;
+	}
+	atomic_store_explicit(ring->cq_head, head, memory_order_release);
+	
+	/* Re-arm now, a caller polling the ring fd sees nothing until then */
+	if (rx->to_submit) {
+		atomic_store_explicit(ring->sq_tail, rx->sq_tail, memory_order_release);
+		ret = io_ring_enter(ring, rx->to_submit, 0, 0);
+		if (ret > 0)
+			rx->to_submit -= (unsigned int)ret < rx->to_submit ? (unsigned int)ret : rx->to_submit;
+	}
+	
+	if (handled)
+		atomic_fetch_add_explicit(&rx->batches, 1, memory_order_relaxed);
+	
+	return handled;
+}
+
+static void source_free(struct io_recv *rx, struct io_recv_source *src)
+{
+	struct io_uring_buf_reg reg;
+	unsigned int i;
+	
+	if (src->br) {
+		memset(&reg, 0, sizeof(reg));
+		reg.bgid = (uint16_t)(src - rx->sources);
+		io_ring_register(&rx->ring, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+		munmap(src->br, src->br_size);
+	}
+	
+	if (src->bufs) {
+		for (i = 0; i < rx->buffer_count; i++)
+			if (src->bufs[i])
+				nlmon_nl_msgpool_free(rx->pool, src->bufs[i]);
+		free(src->bufs);
+	}
+	
+	memset(src, 0, sizeof(*src));
+	src->fd = -1;
+}
+
+/* Map and register the source's buffer ring and fill it */
+static int source_buffers(struct io_recv *rx, struct io_recv_source *src)
+{
+	struct io_uring_buf_reg reg;
+	unsigned int i;
+	long page = sysconf(_SC_PAGESIZE);
+	
+	src->br_size = rx->buffer_count * sizeof(struct io_uring_buf);
+	src->br_size = (src->br_size + (size_t)page - 1) & ~((size_t)page - 1);
+	src->br = mmap(NULL, src->br_size, PROT_READ | PROT_WRITE,
+	               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (src->br == MAP_FAILED) {
+		src->br = NULL;
+		return -ENOMEM;
+	}
+	
+	src->bufs = calloc(rx->buffer_count, sizeof(*src->bufs));
+	if (!src->bufs)
+		return -ENOMEM;
+	
+	for (i = 0; i < rx->buffer_count; i++) {
+		src->bufs[i] = nlmon_nl_msgpool_alloc(rx->pool, rx->buffer_size);
+		if (!src->bufs[i])
+			return -ENOMEM;
+	}
+	
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)src->br;
+	reg.ring_entries = rx->buffer_count;
+	reg.bgid = (uint16_t)(src - rx->sources);
+	if (io_ring_register(&rx->ring, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		int ret = -errno;
+		
+		munmap(src->br, src->br_size);
+		src->br = NULL;
+		return ret;
+	}
+	
+	for (i = 0; i < rx->buffer_count; i++)
+		recycle(rx, src, i);
+	
+	return 0;
+}
+
+int io_recv_add(struct io_recv *rx, int fd, socklen_t namelen, io_recv_fn fn, void *ctx)
+{
+	struct io_recv_source *src;
+	int ret;
+	
+	if (!rx || fd < 0 || !fn)
+		return -EINVAL;
+	if (rx->source_count >= IO_RECV_MAX_SOURCES)
+		return -ENOSPC;
+	
+	/* The name and the header must leave room for a datagram */
+	if (sizeof(struct io_uring_recvmsg_out) + namelen >= rx->buffer_size / 2)
+		return -EINVAL;
+	
+	src = &rx->sources[rx->source_count];
+	memset(src, 0, sizeof(*src));
+	src->fd = fd;
+	src->fn = fn;
+	src->ctx = ctx;
+	src->msg.msg_namelen = namelen;
+	source_dropped(src);
+	
+	ret = source_buffers(rx, src);
+	if (ret < 0) {
+		source_free(rx, src);
+		return ret;
+	}
+	
+	arm_source(rx, src);
+	return (int)rx->source_count++;
+}
+
+int io_recv_set_fd(struct io_recv *rx, int source, int fd)
+{
+	struct io_recv_source *src;
+	
+	if (!rx || source < 0 || (unsigned int)source >= rx->source_count)
+		return -EINVAL;
+	src = &rx->sources[source];
+	
+	if (src->armed)
+		cancel_source(rx, src);
+	
+	src->generation++;
+	src->armed = false;
+	src->fd = fd;
+	if (fd >= 0) {
+		source_dropped(src);
+		arm_source(rx, src);
+	}
+	
+	return 0;
+}
+
+struct io_recv *io_recv_create(const struct io_recv_config *config)
+{
+	struct io_uring_buf_reg reg;
+	struct io_recv *rx;
+	unsigned int count = IO_RECV_DEFAULT_BUFFERS;
+	int saved;
+	
+	if (config && config->buffer_count) {
+		count = 1;
+		while (count < config->buffer_count && count < IO_RECV_MAX_BUFFERS)
+			count <<= 1;
+	}
+	
+	rx = calloc(1, sizeof(*rx));
+	if (!rx)
+		return NULL;
+	
+	rx->buffer_count = count;
+	rx->buffer_size = config && config->buffer_size ? config->buffer_size :
+	                  IO_RECV_DEFAULT_BUFFER_SIZE;
+	rx->wake_fd = -1;
+	rx->ring.fd = -1;
+	
+	/* Completions for every buffer in flight, so multishot rarely overflows */
+	if (io_ring_setup(&rx->ring, IO_RECV_SQ_ENTRIES, count * IO_RECV_MAX_SOURCES) < 0 &&
+	    io_ring_setup(&rx->ring, IO_RECV_SQ_ENTRIES, 0) < 0)
+		goto fail;
+	rx->sq_tail = atomic_load_explicit(rx->ring.sq_tail, memory_order_relaxed);
+	
+	/* Rings without provided buffer support fail here rather than on the first receive */
+	memset(&reg, 0, sizeof(reg));
+	reg.bgid = UINT16_MAX;
+	if (io_ring_register(&rx->ring, IORING_UNREGISTER_PBUF_RING, &reg, 1) == 0 ||
+	    errno != ENOENT) {
+		errno = EINVAL;
+		goto fail;
+	}
+	
+	if (config && config->pool) {
+		rx->pool = config->pool;
+	} else {
+		rx->pool = nlmon_nl_msgpool_create(count, rx->buffer_size);
+		if (!rx->pool)
+			goto fail;
+		rx->own_pool = true;
+	}
+	
+	rx->wake_fd = eventfd(0, EFD_CLOEXEC);
+	if (rx->wake_fd < 0)
+		goto fail;
+	arm_wake(rx);
+	
+	atomic_init(&rx->datagrams, 0);
+	atomic_init(&rx->bytes, 0);
+	atomic_init(&rx->truncated, 0);
+	atomic_init(&rx->errors, 0);
+	atomic_init(&rx->rearms, 0);
+	atomic_init(&rx->exhausted, 0);
+	atomic_init(&rx->batches, 0);
+	return rx;
+	
+fail:
+	saved = errno;
+	if (rx->wake_fd >= 0)
+		close(rx->wake_fd);
+	if (rx->own_pool)
+		nlmon_nl_msgpool_destroy(rx->pool);
+	io_ring_close(&rx->ring);
+	free(rx);
+	errno = saved;
+	return NULL;
+}
+
+void io_recv_destroy(struct io_recv *rx)
+{
+	unsigned int i;
+	int rounds;
+	
+	if (!rx)
+		return;
+	
+	/* The kernel may still fill a buffer until its receive is cancelled */
+	for (i = 0; i < rx->source_count; i++) {
+		struct io_recv_source *src = &rx->sources[i];
+		
+		if (src->armed)
+			cancel_source(rx, src);
+		src->fd = -1;
+	}
+	
+	for (rounds = 0; rounds < 100; rounds++) {
+		bool armed = false;
+		
+		for (i = 0; i < rx->source_count; i++)
+			armed |= rx->sources[i].armed;
+		if (!armed)
+			break;
+		io_recv_wake(rx);
+		if (io_recv_run(rx, true) < 0)
+			break;
+	}
+	
+	for (i = 0; i < rx->source_count; i++)
+		source_free(rx, &rx->sources[i]);
+	
+	io_ring_close(&rx->ring);
+	close(rx->wake_fd);
+	if (rx->own_pool)
+		nlmon_nl_msgpool_destroy(rx->pool);
+	free(rx);
+}
+
+void io_recv_wake(struct io_recv *rx)
+{
+	uint64_t one = 1;
+	
+	if (rx && write(rx->wake_fd, &one, sizeof(one)) < 0) {
+		/* Counter full, a wakeup is already pending */
+	}
+}
+
+int io_recv_get_fd(struct io_recv *rx)
+{
+	return rx ? rx->ring.fd : -1;
+}
+
+void io_recv_get_stats(struct io_recv *rx, struct io_recv_stats *stats)
+{
+	if (!stats)
+		return;
+	
+	memset(stats, 0, sizeof(*stats));
+	if (!rx)
+		return;
+	
+	stats->datagrams = atomic_load_explicit(&rx->datagrams, memory_order_relaxed);
+	stats->bytes = atomic_load_explicit(&rx->bytes, memory_order_relaxed);
+	stats->truncated = atomic_load_explicit(&rx->truncated, memory_order_relaxed);
+	stats->errors = atomic_load_explicit(&rx->errors, memory_order_relaxed);
+	stats->rearms = atomic_load_explicit(&rx->rearms, memory_order_relaxed);
+	stats->exhausted = atomic_load_explicit(&rx->exhausted, memory_order_relaxed);
+	stats->batches = atomic_load_explicit(&rx->batches, memory_order_relaxed);
+	stats->sources = rx->source_count;
+	stats->buffers = rx->source_count * rx->buffer_count;
+}
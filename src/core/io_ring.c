@@ -0,0 +1,135 @@
+/* io_ring.c - Mapped io_uring shared by the I/O services */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "io_ring.h"
+
+int io_ring_enter(struct io_ring *ring, unsigned int to_submit, unsigned int min_complete,
+                  unsigned int flags)
+{
+	return (int)syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete, flags,
+	                    NULL, 0);
+}
+
+int io_ring_register(struct io_ring *ring, unsigned int opcode, const void *arg,
+                     unsigned int nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, ring->fd, opcode, arg, nr_args);
+}
+
+void io_ring_close(struct io_ring *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_map && ring->cq_map != ring->sq_map)
+		munmap(ring->cq_map, ring->cq_map_size);
+	if (ring->sq_map)
+		munmap(ring->sq_map, ring->sq_map_size);
+	if (ring->fd >= 0)
+		close(ring->fd);
+	
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+}
+
+int io_ring_setup(struct io_ring *ring, unsigned int entries, unsigned int cq_entries)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+	
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+	if (cq_entries) {
+		p.flags |= IORING_SETUP_CQSIZE;
+		p.cq_entries = cq_entries;
+	}
+	
+	ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0)
+		return -1;
+	ring->features = p.features;
+	
+	ring->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if ((p.features & IORING_FEAT_SINGLE_MMAP) && ring->cq_map_size > ring->sq_map_size)
+		ring->sq_map_size = ring->cq_map_size;
+	
+	ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+	                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_map == MAP_FAILED) {
+		ring->sq_map = NULL;
+		io_ring_close(ring);
+		return -1;
+	}
+	
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_map = ring->sq_map;
+	} else {
+		ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+		                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_map == MAP_FAILED) {
+			ring->cq_map = NULL;
+			io_ring_close(ring);
+			return -1;
+		}
+	}
+	
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+	                  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		io_ring_close(ring);
+		return -1;
+	}
+	
+	sq = ring->sq_map;
+	cq = ring->cq_map;
+	ring->sq_head = (_Atomic unsigned int *)(sq + p.sq_off.head);
+	ring->sq_tail = (_Atomic unsigned int *)(sq + p.sq_off.tail);
+	ring->sq_mask = *(unsigned int *)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	ring->cq_head = (_Atomic unsigned int *)(cq + p.cq_off.head);
+	ring->cq_tail = (_Atomic unsigned int *)(cq + p.cq_off.tail);
+	ring->cq_mask = *(unsigned int *)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	
+	return 0;
+}
+
+struct io_uring_sqe *io_ring_sqe(struct io_ring *ring, unsigned int *tail)
+{
+	unsigned int index = *tail & ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[index] = index;
+	(*tail)++;
+	return sqe;
+}
+
+void io_ring_submit(struct io_ring *ring, unsigned int tail, unsigned int count)
+{
+	int ret;
+	
+	atomic_store_explicit(ring->sq_tail, tail, memory_order_release);
+	
+	do {
+		ret = io_ring_enter(ring, count, 0, 0);
+		if (ret >= 0) {
+			count -= (unsigned int)ret;
+			continue;
+		}
+		if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			break;
+		sched_yield();
+	} while (count > 0);
+}
@@ -0,0 +1,493 @@
+/* io_service.c - Asynchronous file write service
+ *
+ * Every buffer has a slot that carries the request using it, so the
+ * number of requests in flight is bounded by the buffers and the rings
+ * never overflow. The io_uring backend talks to the kernel through the
+ * raw system calls: submissions are made under the service mutex, a
+ * completion thread reaps the completion queue and runs the callbacks.
+ * A write with IO_WRITE_DATASYNC is submitted as a write linked to a
+ * fdatasync, the slot completes when both have.
+ *
+ * The writer thread backend takes the slots in submission order and
+ * calls pwrite() and fdatasync() itself.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include "io_ring.h"
+#include "io_service.h"
+
+/* Slot user data carries this bit on the fdatasync of a chain */
+#define IO_SYNC_BIT 1ULL
+
+/* User data of the no-op that stops the completion thread */
+#define IO_STOP_DATA 0ULL
+
+/* One buffer and the request using it */
+struct io_slot {
+	struct io_buffer buf;
+	struct iovec iov;                 /* Unregistered buffers are written with writev */
+	unsigned int index;
+	
+	int fd;
+	uint64_t offset;
+	unsigned int flags;
+	io_complete_t done;
+	void *ctx;
+	int result;
+	unsigned int cqes;                /* Completions still expected */
+	
+	struct io_slot *next;             /* Free list or writer thread queue */
+};
+
+struct io_service {
+	struct io_slot *slots;
+	size_t slot_count;
+	void *memory;
+	
+	bool uring;
+	bool registered;
+	struct io_ring ring;
+	pthread_t thread;                 /* Completion or writer thread */
+	
+	/* Free slots and the writer thread queue */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;              /* A slot finished */
+	pthread_cond_t work;              /* Writer thread queue not empty */
+	struct io_slot *free_list;
+	struct io_slot *queue_head;
+	struct io_slot *queue_tail;
+	size_t in_flight;
+	bool stop;
+	
+	/* Statistics */
+	atomic_ulong writes;
+	atomic_ulong syncs;
+	atomic_ulong bytes;
+	atomic_ulong errors;
+	atomic_ulong buffer_waits;
+};
+
+/* Queue the slot's write, and its fdatasync, under the mutex */
+static void uring_queue(struct io_service *svc, struct io_slot *slot)
+{
+	struct io_ring *ring = &svc->ring;
+	unsigned int tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+	struct io_uring_sqe *sqe;
+	
+	slot->cqes = 1;
+	
+	sqe = io_ring_sqe(ring, &tail);
+	sqe->fd = slot->fd;
+	sqe->off = slot->offset;
+	sqe->user_data = (uint64_t)(uintptr_t)slot;
+	if (svc->registered) {
+		sqe->opcode = IORING_OP_WRITE_FIXED;
+		sqe->addr = (uint64_t)(uintptr_t)slot->buf.data;
+		sqe->len = (unsigned int)slot->buf.len;
+		sqe->buf_index = (uint16_t)slot->index;
+	} else {
+		slot->iov.iov_base = slot->buf.data;
+		slot->iov.iov_len = slot->buf.len;
+		sqe->opcode = IORING_OP_WRITEV;
+		sqe->addr = (uint64_t)(uintptr_t)&slot->iov;
+		sqe->len = 1;
+	}
+	
+	if (slot->flags & IO_WRITE_DATASYNC) {
+		sqe->flags |= IOSQE_IO_LINK;
+		
+		sqe = io_ring_sqe(ring, &tail);
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fd = slot->fd;
+		sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+		sqe->user_data = (uint64_t)(uintptr_t)slot | IO_SYNC_BIT;
+		slot->cqes++;
+	}
+	
+	io_ring_submit(ring, tail, slot->cqes);
+}
+
+/* Write what a short write left over, false on error */
+static bool write_rest(struct io_slot *slot, size_t done)
+{
+	const char *data = slot->buf.data;
+	
+	while (done < slot->buf.len) {
+		ssize_t n = pwrite(slot->fd, data + done, slot->buf.len - done,
+		                   (off_t)(slot->offset + done));
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			slot->result = -errno;
+			return false;
+		}
+		done += (size_t)n;
+	}
+	
+	return true;
+}
+
+/* Report the slot's result and recycle it */
+static void slot_finish(struct io_service *svc, struct io_slot *slot)
+{
+	if (slot->result < 0) {
+		atomic_fetch_add_explicit(&svc->errors, 1, memory_order_relaxed);
+	} else {
+		atomic_fetch_add_explicit(&svc->writes, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&svc->bytes, slot->buf.len, memory_order_relaxed);
+		if (slot->flags & IO_WRITE_DATASYNC)
+			atomic_fetch_add_explicit(&svc->syncs, 1, memory_order_relaxed);
+	}
+	
+	if (slot->done)
+		slot->done(slot->ctx, slot->result);
+	
+	pthread_mutex_lock(&svc->mutex);
+	slot->next = svc->free_list;
+	svc->free_list = slot;
+	svc->in_flight--;
+	pthread_cond_broadcast(&svc->cond);
+	pthread_mutex_unlock(&svc->mutex);
+}
+
+static void uring_complete(struct io_service *svc, struct io_uring_cqe *cqe)
+{
+	struct io_slot *slot = (struct io_slot *)(uintptr_t)(cqe->user_data & ~IO_SYNC_BIT);
+	
+	if (cqe->user_data & IO_SYNC_BIT) {
+		/* A short write cuts the link, the fdatasync is then ours */
+		if (cqe->res == -ECANCELED && slot->result == 0) {
+			if (fdatasync(slot->fd) != 0)
+				slot->result = -errno;
+		} else if (cqe->res < 0 && slot->result == 0) {
+			slot->result = cqe->res;
+		}
+	} else if (cqe->res < 0) {
+		slot->result = cqe->res;
+	} else if ((size_t)cqe->res < slot->buf.len) {
+		write_rest(slot, (size_t)cqe->res);
+	}
+	
+	if (--slot->cqes == 0)
+		slot_finish(svc, slot);
+}
+
+static void *uring_thread(void *arg)
+{
+	struct io_service *svc = arg;
+	struct io_ring *ring = &svc->ring;
+	bool stop = false;
+	
+	while (!stop) {
+		unsigned int head, tail;
+		
+		if (io_ring_enter(ring, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+		    errno != EINTR)
+			break;
+		
+		head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+		tail = atomic_load_explicit(ring->cq_tail, memory_order_acquire);
+		while (head != tail) {
+			struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+			
+			if (cqe->user_data == IO_STOP_DATA)
+				stop = true;
+			else
+				uring_complete(svc, cqe);
+			head++;
+		}
+		atomic_store_explicit(ring->cq_head, head, memory_order_release);
+	}
+	
+	return NULL;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct io_service *svc = arg;
+	struct io_slot *slot;
+	
+	while (1) {
+		pthread_mutex_lock(&svc->mutex);
+		while (!svc->queue_head && !svc->stop)
+			pthread_cond_wait(&svc->work, &svc->mutex);
+		slot = svc->queue_head;
+		if (!slot) {
+			pthread_mutex_unlock(&svc->mutex);
+			break;
+		}
+		svc->queue_head = slot->next;
+		if (!svc->queue_head)
+			svc->queue_tail = NULL;
+		pthread_mutex_unlock(&svc->mutex);
+		
+		if (write_rest(slot, 0) && (slot->flags & IO_WRITE_DATASYNC) &&
+		    fdatasync(slot->fd) != 0)
+			slot->result = -errno;
+		
+		slot_finish(svc, slot);
+	}
+	
+	return NULL;
+}
+
+/* Set up the ring and register the buffers, false to use the writer thread */
+static bool uring_init(struct io_service *svc)
+{
+	struct iovec *iovs;
+	unsigned int entries = 1;
+	size_t i;
+	
+	/* A chain per slot and the stop no-op */
+	while (entries < svc->slot_count * 2 + 1)
+		entries <<= 1;
+	
+	if (io_ring_setup(&svc->ring, entries, 0) < 0)
+		return false;
+	
+	iovs = calloc(svc->slot_count, sizeof(*iovs));
+	if (iovs) {
+		for (i = 0; i < svc->slot_count; i++) {
+			iovs[i].iov_base = svc->slots[i].buf.data;
+			iovs[i].iov_len = svc->slots[i].buf.size;
+		}
+		svc->registered = io_ring_register(&svc->ring, IORING_REGISTER_BUFFERS,
+		                                    iovs, (unsigned int)svc->slot_count) == 0;
+		free(iovs);
+	}
+	
+	if (pthread_create(&svc->thread, NULL, uring_thread, svc) != 0) {
+		io_ring_close(&svc->ring);
+		svc->registered = false;
+		return false;
+	}
+	
+	return true;
+}
+
+struct io_service *io_service_create(const struct io_service_config *config)
+{
+	struct io_service *svc;
+	size_t count, size, i;
+	
+	count = config && config->buffer_count ? config->buffer_count : IO_SERVICE_DEFAULT_BUFFERS;
+	size = config && config->buffer_size ? config->buffer_size : IO_SERVICE_DEFAULT_BUFFER_SIZE;
+	
+	/* Registered buffer indexes are 16 bits */
+	if (count > UINT16_MAX)
+		count = UINT16_MAX;
+	
+	svc = calloc(1, sizeof(*svc));
+	if (!svc)
+		return NULL;
+	
+	svc->slot_count = count;
+	svc->ring.fd = -1;
+	svc->slots = calloc(count, sizeof(*svc->slots));
+	if (!svc->slots || posix_memalign(&svc->memory, 4096, count * size) != 0) {
+		free(svc->slots);
+		free(svc);
+		return NULL;
+	}
+	
+	for (i = 0; i < count; i++) {
+		struct io_slot *slot = &svc->slots[i];
+		
+		slot->index = (unsigned int)i;
+		slot->buf.data = (char *)svc->memory + i * size;
+		slot->buf.size = size;
+		slot->next = svc->free_list;
+		svc->free_list = slot;
+	}
+	
+	pthread_mutex_init(&svc->mutex, NULL);
+	pthread_cond_init(&svc->cond, NULL);
+	pthread_cond_init(&svc->work, NULL);
+	atomic_init(&svc->writes, 0);
+	atomic_init(&svc->syncs, 0);
+	atomic_init(&svc->bytes, 0);
+	atomic_init(&svc->errors, 0);
+	atomic_init(&svc->buffer_waits, 0);
+	
+	if (!(config && config->no_uring))
+		svc->uring = uring_init(svc);
+	
+	if (!svc->uring && pthread_create(&svc->thread, NULL, writer_thread, svc) != 0) {
+		pthread_cond_destroy(&svc->work);
+		pthread_cond_destroy(&svc->cond);
+		pthread_mutex_destroy(&svc->mutex);
+		free(svc->memory);
+		free(svc->slots);
+		free(svc);
+		return NULL;
+	}
+	
+	return svc;
+}
+
+void io_service_destroy(struct io_service *svc)
+{
+	if (!svc)
+		return;
+	
+	io_service_wait(svc);
+	
+	pthread_mutex_lock(&svc->mutex);
+	svc->stop = true;
+	if (svc->uring) {
+		unsigned int tail = atomic_load_explicit(svc->ring.sq_tail, memory_order_relaxed);
+		struct io_uring_sqe *sqe = io_ring_sqe(&svc->ring, &tail);
+		
+		sqe->opcode = IORING_OP_NOP;
+		sqe->user_data = IO_STOP_DATA;
+		io_ring_submit(&svc->ring, tail, 1);
+	} else {
+		pthread_cond_signal(&svc->work);
+	}
+	pthread_mutex_unlock(&svc->mutex);
+	
+	pthread_join(svc->thread, NULL);
+	
+	/* Closing the ring unregisters the buffers */
+	if (svc->uring)
+		io_ring_close(&svc->ring);
+	
+	pthread_cond_destroy(&svc->work);
+	pthread_cond_destroy(&svc->cond);
+	pthread_mutex_destroy(&svc->mutex);
+	free(svc->memory);
+	free(svc->slots);
+	free(svc);
+}
+
+struct io_buffer *io_service_buffer(struct io_service *svc)
+{
+	struct io_slot *slot;
+	
+	if (!svc)
+		return NULL;
+	
+	pthread_mutex_lock(&svc->mutex);
+	if (!svc->free_list)
+		atomic_fetch_add_explicit(&svc->buffer_waits, 1, memory_order_relaxed);
+	while (!svc->free_list)
+		pthread_cond_wait(&svc->cond, &svc->mutex);
+	slot = svc->free_list;
+	svc->free_list = slot->next;
+	svc->in_flight++;
+	pthread_mutex_unlock(&svc->mutex);
+	
+	slot->buf.len = 0;
+	return &slot->buf;
+}
+
+void io_service_release(struct io_service *svc, struct io_buffer *buf)
+{
+	struct io_slot *slot = (struct io_slot *)buf;
+	
+	if (!svc || !buf)
+		return;
+	
+	pthread_mutex_lock(&svc->mutex);
+	slot->next = svc->free_list;
+	svc->free_list = slot;
+	svc->in_flight--;
+	pthread_cond_broadcast(&svc->cond);
+	pthread_mutex_unlock(&svc->mutex);
+}
+
+bool io_service_write(struct io_service *svc, int fd, uint64_t offset,
+                      struct io_buffer *buf, unsigned int flags,
+                      io_complete_t done, void *ctx)
+{
+	struct io_slot *slot = (struct io_slot *)buf;
+	
+	if (!svc || !buf || fd < 0 || buf->len > buf->size) {
+		io_service_release(svc, buf);
+		return false;
+	}
+	
+	slot->fd = fd;
+	slot->offset = offset;
+	slot->flags = flags;
+	slot->done = done;
+	slot->ctx = ctx;
+	slot->result = 0;
+	slot->next = NULL;
+	
+	pthread_mutex_lock(&svc->mutex);
+	if (svc->uring) {
+		uring_queue(svc, slot);
+	} else {
+		if (svc->queue_tail)
+			svc->queue_tail->next = slot;
+		else
+			svc->queue_head = slot;
+		svc->queue_tail = slot;
+		pthread_cond_signal(&svc->work);
+	}
+	pthread_mutex_unlock(&svc->mutex);
+	
+	return true;
+}
+
+bool io_service_write_data(struct io_service *svc, int fd, uint64_t offset,
+                           const void *data, size_t len, unsigned int flags,
+                           io_complete_t done, void *ctx)
+{
+	const char *p = data;
+	
+	if (!svc || fd < 0 || (!data && len > 0))
+		return false;
+	
+	while (len > 0) {
+		struct io_buffer *buf = io_service_buffer(svc);
+		size_t chunk = len < buf->size ? len : buf->size;
+		
+		memcpy(buf->data, p, chunk);
+		buf->len = chunk;
+		if (!io_service_write(svc, fd, offset, buf, flags, done, ctx))
+			return false;
+		
+		p += chunk;
+		offset += chunk;
+		len -= chunk;
+	}
+	
+	return true;
+}
+
+void io_service_wait(struct io_service *svc)
+{
+	if (!svc)
+		return;
+	
+	pthread_mutex_lock(&svc->mutex);
+	while (svc->in_flight > 0)
+		pthread_cond_wait(&svc->cond, &svc->mutex);
+	pthread_mutex_unlock(&svc->mutex);
+}
+
+void io_service_get_stats(struct io_service *svc, struct io_service_stats *stats)
+{
+	if (!svc || !stats)
+		return;
+	
+	stats->writes = atomic_load_explicit(&svc->writes, memory_order_relaxed);
+	stats->syncs = atomic_load_explicit(&svc->syncs, memory_order_relaxed);
+	stats->bytes = atomic_load_explicit(&svc->bytes, memory_order_relaxed);
+	stats->errors = atomic_load_explicit(&svc->errors, memory_order_relaxed);
+	stats->buffer_waits = atomic_load_explicit(&svc->buffer_waits, memory_order_relaxed);
+	stats->uring = svc->uring;
+	stats->registered = svc->registered;
+}
@@ -0,0 +1,285 @@
+/* json_buf.c - Growable output buffer for building JSON text
+ *
+ * The escaper looks every byte up in a 256 entry table: 0 copies it,
+ * anything else is the character written after a backslash, 'u' for the
+ * \u00XX form. Before each lookup it skips ahead over bytes that cannot
+ * need escaping and copies the whole run with one memcpy.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "json_buf.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Smallest allocation, the buffer doubles from there */
+#define JSON_BUF_MIN_CAP 256
+
+static const char escape_table[256] = {
+	['\0'] = 'u', [0x01] = 'u', [0x02] = 'u', [0x03] = 'u',
+	[0x04] = 'u', [0x05] = 'u', [0x06] = 'u', [0x07] = 'u',
+	['\b'] = 'b', ['\t'] = 't', ['\n'] = 'n', [0x0b] = 'u',
+	['\f'] = 'f', ['\r'] = 'r', [0x0e] = 'u', [0x0f] = 'u',
+	[0x10] = 'u', [0x11] = 'u', [0x12] = 'u', [0x13] = 'u',
+	[0x14] = 'u', [0x15] = 'u', [0x16] = 'u', [0x17] = 'u',
+	[0x18] = 'u', [0x19] = 'u', [0x1a] = 'u', [0x1b] = 'u',
+	[0x1c] = 'u', [0x1d] = 'u', [0x1e] = 'u', [0x1f] = 'u',
+	['"'] = '"', ['\\'] = '\\',
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/* Two decimal digits for each value below 100 */
+static const char digit_pairs[201] =
+	"00010203040506070809101112131415161718192021222324"
+	"25262728293031323334353637383940414243444546474849"
+	"50515253545556575859606162636465666768697071727374"
+	"75767778798081828384858687888990919293949596979899";
+
+bool json_buf_init(struct json_buf *buf, size_t cap)
+{
+	memset(buf, 0, sizeof(*buf));
+	
+	if (cap == 0)
+		return true;
+	
+	buf->data = malloc(cap);
+	if (!buf->data) {
+		buf->failed = true;
+		return false;
+	}
+	
+	buf->data[0] = '\0';
+	buf->cap = cap;
+	return true;
+}
+
+void json_buf_free(struct json_buf *buf)
+{
+	if (!buf)
+		return;
+	
+	free(buf->data);
+	memset(buf, 0, sizeof(*buf));
+}
+
+void json_buf_reset(struct json_buf *buf)
+{
+	buf->len = 0;
+	buf->failed = false;
+	if (buf->data)
+		buf->data[0] = '\0';
+}
+
+bool json_buf_reserve(struct json_buf *buf, size_t extra)
+{
+	size_t need, cap;
+	char *data;
+	
+	if (buf->failed)
+		return false;
+	
+	/* One byte more for the terminator */
+	need = buf->len + extra + 1;
+	if (need <= buf->cap)
+		return true;
+	
+	if (need < buf->len) {
+		buf->failed = true;
+		return false;
+	}
+	
+	cap = buf->cap ? buf->cap : JSON_BUF_MIN_CAP;
+	while (cap < need)
+		cap *= 2;
+	
+	data = realloc(buf->data, cap);
+	if (!data) {
+		buf->failed = true;
+		return false;
+	}
+	
+	buf->data = data;
+	buf->cap = cap;
+	return true;
+}
+
+char *json_buf_detach(struct json_buf *buf)
+{
+	char *data;
+	
+	if (buf->failed) {
+		json_buf_free(buf);
+		return NULL;
+	}
+	
+	if (!json_buf_reserve(buf, 0))
+		return NULL;
+	
+	data = buf->data;
+	data[buf->len] = '\0';
+	memset(buf, 0, sizeof(*buf));
+	return data;
+}
+
+void json_buf_append(struct json_buf *buf, const char *data, size_t len)
+{
+	if (!json_buf_reserve(buf, len))
+		return;
+	
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	buf->data[buf->len] = '\0';
+}
+
+void json_buf_append_char(struct json_buf *buf, char c)
+{
+	if (!json_buf_reserve(buf, 1))
+		return;
+	
+	buf->data[buf->len++] = c;
+	buf->data[buf->len] = '\0';
+}
+
+/* Write the digits of value ending at end, returns where they start */
+static char *format_u64(char *end, uint64_t value)
+{
+	char *p = end;
+	
+	while (value >= 100) {
+		unsigned int pair = (unsigned int)(value % 100) * 2;
+		
+		value /= 100;
+		*--p = digit_pairs[pair + 1];
+		*--p = digit_pairs[pair];
+	}
+	
+	if (value >= 10) {
+		*--p = digit_pairs[value * 2 + 1];
+		*--p = digit_pairs[value * 2];
+	} else {
+		*--p = (char)('0' + value);
+	}
+	
+	return p;
+}
+
+void json_buf_append_u64(struct json_buf *buf, uint64_t value)
+{
+	char digits[20];
+	char *start = format_u64(digits + sizeof(digits), value);
+	
+	json_buf_append(buf, start, (size_t)(digits + sizeof(digits) - start));
+}
+
+void json_buf_append_u64_padded(struct json_buf *buf, uint64_t value, int width)
+{
+	char digits[20];
+	char *end = digits + sizeof(digits);
+	char *start = format_u64(end, value);
+	
+	if (width > (int)sizeof(digits))
+		width = sizeof(digits);
+	
+	while (end - start < width)
+		*--start = '0';
+	
+	json_buf_append(buf, start, (size_t)(end - start));
+}
+
+void json_buf_append_i64(struct json_buf *buf, int64_t value)
+{
+	char digits[21];
+	char *end = digits + sizeof(digits);
+	char *start;
+	
+	/* Negate in unsigned arithmetic so INT64_MIN works */
+	if (value < 0) {
+		start = format_u64(end, -(uint64_t)value);
+		*--start = '-';
+	} else {
+		start = format_u64(end, (uint64_t)value);
+	}
+	
+	json_buf_append(buf, start, (size_t)(end - start));
+}
+
+/* Bytes from the start of str to the first one that needs escaping */
+static size_t safe_prefix(const char *str, size_t len)
+{
+	size_t i = 0;
+	
+#if defined(__SSE2__)
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(0x1f);
+	
+	for (; i + 16 <= len; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)(str + i));
+		
+		/* Unsigned chunk <= 0x1f is max(chunk, 0x1f) == 0x1f */
+		__m128i unsafe = _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control);
+		
+		unsafe = _mm_or_si128(unsafe, _mm_cmpeq_epi8(chunk, quote));
+		unsafe = _mm_or_si128(unsafe, _mm_cmpeq_epi8(chunk, backslash));
+		
+		int mask = _mm_movemask_epi8(unsafe);
+		if (mask)
+			return i + (size_t)__builtin_ctz((unsigned int)mask);
+	}
+#endif
+	
+	while (i < len && !escape_table[(unsigned char)str[i]])
+		i++;
+	
+	return i;
+}
+
+void json_buf_append_escaped(struct json_buf *buf, const char *str, size_t len)
+{
+	size_t pos = 0;
+	
+	/* Unescaped text is the common case, reserve for it once */
+	if (!json_buf_reserve(buf, len))
+		return;
+	
+	while (pos < len) {
+		size_t run = safe_prefix(str + pos, len - pos);
+		unsigned char c;
+		char esc;
+		
+		if (run) {
+			json_buf_append(buf, str + pos, run);
+			pos += run;
+			if (pos == len)
+				break;
+		}
+		
+		c = (unsigned char)str[pos++];
+		esc = escape_table[c];
+		
+		if (esc == 'u') {
+			char seq[6] = { '\\', 'u', '0', '0', hex_digits[c >> 4], hex_digits[c & 0xf] };
+			
+			json_buf_append(buf, seq, sizeof(seq));
+		} else {
+			char seq[2] = { '\\', esc };
+			
+			json_buf_append(buf, seq, sizeof(seq));
+		}
+	}
+}
+
+void json_buf_append_string(struct json_buf *buf, const char *str)
+{
+	if (!str) {
+		json_buf_append(buf, "null", 4);
+		return;
+	}
+	
+	json_buf_append_char(buf, '"');
+	json_buf_append_escaped(buf, str, strlen(str));
+	json_buf_append_char(buf, '"');
+}
@@ -0,0 +1,346 @@
+/* log_ring.c - Deferred binary logging */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "log_ring.h"
+#include "nlmon_clock.h"
+
+/* Ring slot, sequenced as in a bounded MPMC queue */
+struct log_slot {
+	_Atomic uint64_t seq;
+	struct nlmon_log_record rec;
+};
+
+struct log_ring {
+	struct log_slot *slots;
+	uint64_t mask;
+	_Atomic uint64_t head __attribute__((aligned(64)));  /* Next slot to claim */
+	uint64_t tail __attribute__((aligned(64)));          /* Next slot to format */
+	_Atomic uint64_t logged;
+	_Atomic uint64_t dropped;
+	_Atomic uint64_t delivered;
+	_Atomic bool running;
+	pthread_t writer;
+};
+
+struct log_sink {
+	nlmon_log_sink_fn fn;
+	void *ctx;
+};
+
+/* Two slots so that replacing the sink never changes the one in use */
+static struct log_sink sinks[2];
+static _Atomic(struct log_sink *) current_sink;
+static _Atomic(struct log_ring *) current_ring;
+
+static const char *level_names[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+
+const char *nlmon_log_level_name(unsigned int level)
+{
+	return level < sizeof(level_names) / sizeof(level_names[0]) ?
+	       level_names[level] : "UNKNOWN";
+}
+
+void nlmon_log_set_sink(nlmon_log_sink_fn fn, void *ctx)
+{
+	struct log_sink *sink;
+
+	if (!fn) {
+		atomic_store_explicit(&current_sink, NULL, memory_order_release);
+		return;
+	}
+
+	sink = atomic_load_explicit(&current_sink, memory_order_relaxed) == &sinks[0] ?
+	       &sinks[1] : &sinks[0];
+	sink->fn = fn;
+	sink->ctx = ctx;
+	atomic_store_explicit(&current_sink, sink, memory_order_release);
+}
+
+void nlmon_log_default_sink(const struct nlmon_log_record *rec, const char *text, void *ctx)
+{
+	time_t secs = (time_t)(rec->ts_ns / 1000000000ULL);
+	struct tm tm_info;
+	char timestamp[32];
+
+	(void)ctx;
+	localtime_r(&secs, &tm_info);
+	strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm_info);
+
+	if (rec->site->tag)
+		fprintf(stderr, "[%s] [%s-%s] %s\n", timestamp, rec->site->tag,
+		        nlmon_log_level_name(rec->site->level), text);
+	else
+		fprintf(stderr, "[%s] [%s] %s\n", timestamp,
+		        nlmon_log_level_name(rec->site->level), text);
+}
+
+/* Format one conversion, @spec ends with the conversion character */
+static int format_arg(char *out, size_t len, char *spec, size_t speclen, uint64_t arg)
+{
+	char conv = spec[speclen - 1];
+	union { uint64_t u; double d; } bits = { .u = arg };
+	size_t n = speclen - 1;
+
+	/* Arguments are 64-bit, so integers are printed as long long */
+	while (n > 1 && strchr("hljztL", spec[n - 1]))
+		n--;
+
+	switch (conv) {
+	case 'd':
+	case 'i':
+	case 'u':
+	case 'o':
+	case 'x':
+	case 'X':
+		spec[n++] = 'l';
+		spec[n++] = 'l';
+		spec[n++] = conv;
+		spec[n] = '\0';
+		if (conv == 'd' || conv == 'i')
+			return snprintf(out, len, spec, (long long)arg);
+		return snprintf(out, len, spec, (unsigned long long)arg);
+	case 'c':
+		spec[n++] = conv;
+		spec[n] = '\0';
+		return snprintf(out, len, spec, (int)arg);
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		spec[n++] = conv;
+		spec[n] = '\0';
+		return snprintf(out, len, spec, bits.d);
+	case 's':
+		spec[n++] = conv;
+		spec[n] = '\0';
+		return snprintf(out, len, spec, arg ? (const char *)(uintptr_t)arg : "(null)");
+	case 'p':
+		spec[n++] = conv;
+		spec[n] = '\0';
+		return snprintf(out, len, spec, (void *)(uintptr_t)arg);
+	default:
+		return -1;
+	}
+}
+
+int nlmon_log_format(const struct nlmon_log_record *rec, char *buf, size_t len)
+{
+	const char *p = rec->site->fmt;
+	unsigned int argi = 0;
+	size_t pos = 0;
+	int n;
+
+	if (rec->site->render)
+		return rec->site->render(rec, buf, len);
+
+	if (len)
+		buf[0] = '\0';
+	if (!p)
+		return 0;
+
+	while (*p) {
+		char spec[32];
+		size_t speclen = 0;
+
+		if (*p != '%' || p[1] == '%') {
+			if (pos + 1 < len)
+				buf[pos] = *p;
+			pos++;
+			p += *p == '%' ? 2 : 1;
+			continue;
+		}
+
+		/* %[flags][width][.precision][length]conversion */
+		spec[speclen++] = *p++;
+		while (*p && strchr("-+ #0123456789.hljztL", *p) && speclen < sizeof(spec) - 4)
+			spec[speclen++] = *p++;
+		if (!*p || *p == '*' || argi >= rec->nargs)
+			break;
+		spec[speclen++] = *p++;
+		spec[speclen] = '\0';
+
+		n = format_arg(pos < len ? buf + pos : NULL, pos < len ? len - pos : 0,
+		               spec, speclen, rec->args[argi++]);
+		if (n < 0)
+			break;
+		pos += n;
+	}
+
+	if (len)
+		buf[pos < len ? pos : len - 1] = '\0';
+	return (int)pos;
+}
+
+static void log_deliver(const struct nlmon_log_record *rec)
+{
+	struct log_sink *sink = atomic_load_explicit(&current_sink, memory_order_acquire);
+	char text[NLMON_LOG_LINE_MAX];
+
+	nlmon_log_format(rec, text, sizeof(text));
+	if (sink)
+		sink->fn(rec, text, sink->ctx);
+	else
+		nlmon_log_default_sink(rec, text, NULL);
+}
+
+void nlmon_log_submit(const struct nlmon_log_site *site, unsigned int nargs,
+                      const uint64_t *args)
+{
+	struct log_ring *ring = atomic_load_explicit(&current_ring, memory_order_acquire);
+	struct nlmon_log_record local, *rec = &local;
+	struct log_slot *slot = NULL;
+	uint64_t pos, seq;
+
+	if (nargs > NLMON_LOG_MAX_ARGS)
+		nargs = NLMON_LOG_MAX_ARGS;
+
+	if (ring) {
+		atomic_fetch_add_explicit(&ring->logged, 1, memory_order_relaxed);
+		pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+		for (;;) {
+			slot = &ring->slots[pos & ring->mask];
+			seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+			if (seq == pos) {
+				if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1,
+				                                          memory_order_relaxed,
+				                                          memory_order_relaxed))
+					break;
+			} else if ((int64_t)(seq - pos) < 0) {
+				atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+				return;
+			} else {
+				pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+			}
+		}
+		rec = &slot->rec;
+	}
+
+	rec->ts_ns = nlmon_clock_realtime_ns();
+	rec->site = site;
+	rec->nargs = nargs;
+	if (nargs)
+		memcpy(rec->args, args, nargs * sizeof(*args));
+
+	if (!ring) {
+		log_deliver(rec);
+		return;
+	}
+
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+}
+
+/* Format and deliver what is queued, returns the number of records */
+static unsigned int log_drain(struct log_ring *ring)
+{
+	unsigned int count = 0;
+
+	for (;;) {
+		struct log_slot *slot = &ring->slots[ring->tail & ring->mask];
+
+		if (atomic_load_explicit(&slot->seq, memory_order_acquire) != ring->tail + 1)
+			break;
+
+		log_deliver(&slot->rec);
+		atomic_store_explicit(&slot->seq, ring->tail + ring->mask + 1, memory_order_release);
+		ring->tail++;
+		count++;
+	}
+
+	if (count)
+		atomic_fetch_add_explicit(&ring->delivered, count, memory_order_relaxed);
+	return count;
+}
+
+static void *log_writer(void *arg)
+{
+	struct log_ring *ring = arg;
+	struct timespec idle = { 0, NLMON_LOG_IDLE_MS * 1000000L };
+
+	while (atomic_load_explicit(&ring->running, memory_order_acquire)) {
+		if (!log_drain(ring))
+			nanosleep(&idle, NULL);
+	}
+
+	return NULL;
+}
+
+int nlmon_log_start(unsigned int capacity)
+{
+	struct log_ring *ring;
+	uint64_t size = 1, i;
+	int ret;
+
+	if (atomic_load_explicit(&current_ring, memory_order_acquire))
+		return -EALREADY;
+
+	if (!capacity)
+		capacity = NLMON_LOG_RING_DEFAULT;
+	while (size < capacity)
+		size <<= 1;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return -ENOMEM;
+
+	ring->slots = calloc(size, sizeof(*ring->slots));
+	if (!ring->slots) {
+		free(ring);
+		return -ENOMEM;
+	}
+
+	ring->mask = size - 1;
+	for (i = 0; i < size; i++)
+		atomic_init(&ring->slots[i].seq, i);
+	atomic_init(&ring->running, true);
+
+	ret = pthread_create(&ring->writer, NULL, log_writer, ring);
+	if (ret) {
+		free(ring->slots);
+		free(ring);
+		return -ret;
+	}
+
+	atomic_store_explicit(&current_ring, ring, memory_order_release);
+	return 0;
+}
+
+void nlmon_log_stop(void)
+{
+	struct log_ring *ring = atomic_exchange_explicit(&current_ring, NULL,
+	                                                 memory_order_acq_rel);
+
+	if (!ring)
+		return;
+
+	atomic_store_explicit(&ring->running, false, memory_order_release);
+	pthread_join(ring->writer, NULL);
+	log_drain(ring);
+
+	free(ring->slots);
+	free(ring);
+}
+
+void nlmon_log_get_stats(struct nlmon_log_stats *stats)
+{
+	struct log_ring *ring = atomic_load_explicit(&current_ring, memory_order_acquire);
+
+	memset(stats, 0, sizeof(*stats));
+	if (!ring)
+		return;
+
+	stats->logged = atomic_load_explicit(&ring->logged, memory_order_relaxed);
+	stats->dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+	stats->delivered = atomic_load_explicit(&ring->delivered, memory_order_relaxed);
+}
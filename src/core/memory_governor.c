@@ -0,0 +1,298 @@
+/* memory_governor.c - One memory budget across pools and buffers */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "memory_governor.h"
+
+#define DEFAULT_LOW_PCT 70
+#define DEFAULT_HIGH_PCT 85
+#define DEFAULT_CRITICAL_PCT 95
+#define DEFAULT_HYSTERESIS_PCT 5
+
+struct memory_subsystem {
+	const char *name;
+	size_t share;
+	memory_usage_fn usage_fn;
+	memory_respond_fn respond;
+	void *ctx;
+	
+	/* Last check, guarded by the governor lock */
+	size_t usage;
+	size_t target;
+	enum memory_pressure level;
+	uint64_t responses;
+};
+
+struct memory_governor {
+	size_t budget;
+	unsigned int threshold[MEMORY_PRESSURE_CRITICAL + 1];  /* Budget use per level */
+	unsigned int hysteresis;
+	bool count_rss;
+	
+	pthread_mutex_t lock;
+	struct memory_subsystem subsystems[MEMORY_GOVERNOR_MAX_SUBSYSTEMS];
+	size_t num_subsystems;
+	unsigned int shares_pct;
+	
+	/* Last check */
+	_Atomic int level;
+	size_t usage;
+	size_t rss;
+	enum memory_pressure peak_level;
+	uint64_t checks;
+	uint64_t escalations;
+};
+
+static const char *const pressure_names[] = {
+	[MEMORY_PRESSURE_NONE] = "none",
+	[MEMORY_PRESSURE_LOW] = "low",
+	[MEMORY_PRESSURE_HIGH] = "high",
+	[MEMORY_PRESSURE_CRITICAL] = "critical",
+};
+
+const char *memory_pressure_name(enum memory_pressure level)
+{
+	if (level < MEMORY_PRESSURE_NONE || level > MEMORY_PRESSURE_CRITICAL)
+		return "unknown";
+	return pressure_names[level];
+}
+
+struct memory_governor *memory_governor_create(const struct memory_governor_config *config)
+{
+	struct memory_governor *gov;
+	
+	if (!config || config->budget == 0)
+		return NULL;
+	
+	gov = calloc(1, sizeof(*gov));
+	if (!gov)
+		return NULL;
+	
+	gov->budget = config->budget;
+	gov->threshold[MEMORY_PRESSURE_LOW] = config->low_pct ? config->low_pct : DEFAULT_LOW_PCT;
+	gov->threshold[MEMORY_PRESSURE_HIGH] = config->high_pct ? config->high_pct : DEFAULT_HIGH_PCT;
+	gov->threshold[MEMORY_PRESSURE_CRITICAL] = config->critical_pct ? config->critical_pct :
+	                                           DEFAULT_CRITICAL_PCT;
+	gov->hysteresis = config->hysteresis_pct ? config->hysteresis_pct : DEFAULT_HYSTERESIS_PCT;
+	gov->count_rss = config->count_rss;
+	
+	/* Levels must be reached in order */
+	if (gov->threshold[MEMORY_PRESSURE_LOW] >= gov->threshold[MEMORY_PRESSURE_HIGH] ||
+	    gov->threshold[MEMORY_PRESSURE_HIGH] >= gov->threshold[MEMORY_PRESSURE_CRITICAL] ||
+	    gov->hysteresis >= gov->threshold[MEMORY_PRESSURE_LOW]) {
+		free(gov);
+		return NULL;
+	}
+	
+	if (pthread_mutex_init(&gov->lock, NULL) != 0) {
+		free(gov);
+		return NULL;
+	}
+	atomic_init(&gov->level, MEMORY_PRESSURE_NONE);
+	
+	return gov;
+}
+
+void memory_governor_destroy(struct memory_governor *gov)
+{
+	if (!gov)
+		return;
+	
+	pthread_mutex_destroy(&gov->lock);
+	free(gov);
+}
+
+int memory_governor_add(struct memory_governor *gov, const char *name, unsigned int share_pct,
+                        memory_usage_fn usage, memory_respond_fn respond, void *ctx)
+{
+	struct memory_subsystem *sub;
+	int ret = -1;
+	
+	if (!gov || !name || !usage)
+		return -1;
+	
+	pthread_mutex_lock(&gov->lock);
+	
+	if (gov->num_subsystems < MEMORY_GOVERNOR_MAX_SUBSYSTEMS &&
+	    gov->shares_pct + share_pct <= 100) {
+		sub = &gov->subsystems[gov->num_subsystems++];
+		memset(sub, 0, sizeof(*sub));
+		sub->name = name;
+		sub->share = (size_t)((double)gov->budget * share_pct / 100.0);
+		sub->usage_fn = usage;
+		sub->respond = respond;
+		sub->ctx = ctx;
+		gov->shares_pct += share_pct;
+		ret = 0;
+	}
+	
+	pthread_mutex_unlock(&gov->lock);
+	
+	return ret;
+}
+
+size_t memory_governor_process_rss(void)
+{
+	unsigned long size, resident;
+	long page_size = sysconf(_SC_PAGESIZE);
+	FILE *fp;
+	int n;
+	
+	fp = fopen("/proc/self/statm", "r");
+	if (!fp)
+		return 0;
+	n = fscanf(fp, "%lu %lu", &size, &resident);
+	fclose(fp);
+	
+	if (n != 2 || page_size <= 0)
+		return 0;
+	return (size_t)resident * (size_t)page_size;
+}
+
+/* Level for a budget use, leaving @current only past the hysteresis */
+static enum memory_pressure pressure_level(struct memory_governor *gov, size_t used,
+                                           enum memory_pressure current)
+{
+	double pct = (double)used * 100.0 / (double)gov->budget;
+	enum memory_pressure level = MEMORY_PRESSURE_NONE;
+	int l;
+	
+	for (l = MEMORY_PRESSURE_CRITICAL; l > MEMORY_PRESSURE_NONE; l--) {
+		if (pct >= gov->threshold[l]) {
+			level = (enum memory_pressure)l;
+			break;
+		}
+	}
+	
+	while (current > level && pct < (double)(gov->threshold[current] - gov->hysteresis))
+		current--;
+	
+	return current > level ? current : level;
+}
+
+enum memory_pressure memory_governor_check(struct memory_governor *gov)
+{
+	enum memory_pressure level, previous;
+	size_t i, usage = 0, used;
+	
+	if (!gov)
+		return MEMORY_PRESSURE_NONE;
+	
+	pthread_mutex_lock(&gov->lock);
+	
+	for (i = 0; i < gov->num_subsystems; i++) {
+		struct memory_subsystem *sub = &gov->subsystems[i];
+		
+		sub->usage = sub->usage_fn(sub->ctx);
+		usage += sub->usage;
+	}
+	
+	/* Other allocations count as well, the OOM killer sees the resident set */
+	gov->usage = usage;
+	gov->rss = gov->count_rss ? memory_governor_process_rss() : 0;
+	used = gov->rss > usage ? gov->rss : usage;
+	
+	previous = (enum memory_pressure)atomic_load_explicit(&gov->level, memory_order_relaxed);
+	level = pressure_level(gov, used, previous);
+	atomic_store_explicit(&gov->level, level, memory_order_relaxed);
+	
+	gov->checks++;
+	if (level > previous)
+		gov->escalations++;
+	if (level > gov->peak_level)
+		gov->peak_level = level;
+	
+	for (i = 0; i < gov->num_subsystems; i++) {
+		struct memory_subsystem *sub = &gov->subsystems[i];
+		enum memory_pressure sub_level = level;
+		size_t target = 0;
+		
+		/* Only those over their share restrict buffers or shed load */
+		if (sub->usage <= sub->share && sub_level > MEMORY_PRESSURE_LOW)
+			sub_level = MEMORY_PRESSURE_LOW;
+		
+		/* Critical asks for room below the share, so the level can drop */
+		if (level == MEMORY_PRESSURE_CRITICAL)
+			target = sub->share / 100 * gov->threshold[MEMORY_PRESSURE_LOW];
+		else if (level > MEMORY_PRESSURE_NONE)
+			target = sub->share;
+		
+		if (sub_level == sub->level && target == sub->target)
+			continue;
+		
+		sub->level = sub_level;
+		sub->target = target;
+		if (sub->respond) {
+			sub->respond(sub->ctx, sub_level, target);
+			sub->responses++;
+		}
+	}
+	
+	pthread_mutex_unlock(&gov->lock);
+	
+	return level;
+}
+
+void memory_governor_notify(const struct nlmon_stats_snapshot *snapshot, void *ctx)
+{
+	memory_governor_check(ctx);
+}
+
+enum memory_pressure memory_governor_level(struct memory_governor *gov)
+{
+	if (!gov)
+		return MEMORY_PRESSURE_NONE;
+	
+	return (enum memory_pressure)atomic_load_explicit(&gov->level, memory_order_relaxed);
+}
+
+void memory_governor_get_stats(struct memory_governor *gov, struct memory_governor_stats *stats)
+{
+	if (!gov || !stats)
+		return;
+	
+	pthread_mutex_lock(&gov->lock);
+	
+	stats->budget = gov->budget;
+	stats->usage = gov->usage;
+	stats->rss = gov->rss;
+	stats->level = (enum memory_pressure)atomic_load_explicit(&gov->level, memory_order_relaxed);
+	stats->peak_level = gov->peak_level;
+	stats->checks = gov->checks;
+	stats->escalations = gov->escalations;
+	stats->num_subsystems = gov->num_subsystems;
+	
+	pthread_mutex_unlock(&gov->lock);
+}
+
+size_t memory_governor_get_subsystems(struct memory_governor *gov,
+                                      struct memory_subsystem_stats *subsystems, size_t max)
+{
+	size_t i, n;
+	
+	if (!gov || !subsystems)
+		return 0;
+	
+	pthread_mutex_lock(&gov->lock);
+	
+	n = gov->num_subsystems < max ? gov->num_subsystems : max;
+	for (i = 0; i < n; i++) {
+		const struct memory_subsystem *sub = &gov->subsystems[i];
+		
+		subsystems[i].name = sub->name;
+		subsystems[i].usage = sub->usage;
+		subsystems[i].share = sub->share;
+		subsystems[i].target = sub->target;
+		subsystems[i].level = sub->level;
+		subsystems[i].responses = sub->responses;
+	}
+	
+	pthread_mutex_unlock(&gov->lock);
+	
+	return n;
+}
@@ -1,4 +1,17 @@
-/* memory_tracker.c - Memory usage tracking implementation */
+/* memory_tracker.c - Memory usage tracking implementation
+ *
+ * Live allocations are kept in an open addressed hash of pointers split
+ * into MT_STRIPES stripes, each with a lock and a table of its own, so
+ * threads rarely wait on each other and a lookup stays one probe however
+ * many allocations are live. Removal shifts entries back instead of
+ * leaving tombstones. Each entry names the call site it came from; sites
+ * are kept in a fixed table found by the address of their name, without
+ * a lock, and carry atomic live and total figures.
+ *
+ * When sampling, an allocation is entered with probability
+ * size / interval and weighs interval bytes, or its size if larger. Frees
+ * of allocations that were not entered find nothing and only count.
+ */
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -7,13 +20,36 @@
 #include <pthread.h>
 #include <stdatomic.h>
 #include <unistd.h>
+#include <time.h>
 #include "memory_tracker.h"
 
-/* Allocation entry (for tracking) */
+#define MT_STRIPES 64
+#define MT_STRIPE_BITS 6
+#define MT_INITIAL_SLOTS 64
+
+/* Live allocation, ptr 0 for a free slot */
 struct alloc_entry {
-	void *ptr;
-	size_t size;
-	struct alloc_entry *next;
+	uintptr_t ptr;
+	size_t weight;          /* Bytes it stands for */
+	size_t count;           /* Allocations it stands for */
+	uint32_t site;
+};
+
+struct alloc_stripe {
+	pthread_mutex_t lock;
+	struct alloc_entry *entries;
+	size_t mask;            /* Slots - 1, 0 until the table is allocated */
+	size_t count;
+} __attribute__((aligned(64)));
+
+/* Call site, slot 0 is the unknown one */
+struct alloc_site {
+	_Atomic(const char *) name;
+	_Atomic(const char *) subsystem;
+	atomic_size_t live_bytes;
+	atomic_size_t live_count;
+	atomic_size_t total_bytes;
+	atomic_size_t total_count;
 };
 
 /* Memory tracker structure */
@@ -21,8 +57,10 @@ struct memory_tracker {
 	bool tracking_enabled;
 	
 	/* Allocation tracking */
-	struct alloc_entry *allocations;
-	pthread_mutex_t mutex;
+	struct alloc_stripe *stripes;
+	struct alloc_site *sites;
+	atomic_size_t sample_interval;
+	atomic_ulong tracked;
 	
 	/* System stats */
 	atomic_size_t rss;
@@ -38,9 +76,165 @@ struct memory_tracker {
 	atomic_ulong free_count;
 };
 
+/* Per thread state of the sampling generator, seeded on first use */
+static __thread uint64_t sample_state;
+
+static uint64_t sample_random(void)
+{
+	uint64_t x = sample_state;
+	
+	if (x == 0) {
+		struct timespec ts;
+		
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		x = ((uint64_t)ts.tv_nsec << 20) ^ (uintptr_t)&sample_state ^ 0x9e3779b97f4a7c15ULL;
+		if (x == 0)
+			x = 1;
+	}
+	
+	/* xorshift64 */
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	sample_state = x;
+	return x;
+}
+
+/* Mixes every bit, pointers differ mostly in middle bits */
+static inline uint64_t hash_ptr(uintptr_t ptr)
+{
+	uint64_t x = ptr;
+	
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+static inline struct alloc_stripe *ptr_stripe(struct memory_tracker *tracker, uint64_t hash)
+{
+	return &tracker->stripes[hash >> (64 - MT_STRIPE_BITS)];
+}
+
+/* Site slot for a name, taking a free one if it is new */
+static uint32_t find_site(struct memory_tracker *tracker, const char *name,
+                          const char *subsystem)
+{
+	uint32_t i, start;
+	
+	if (!name)
+		return 0;
+	
+	start = (uint32_t)(hash_ptr((uintptr_t)name) >> 40) % (MEMORY_TRACKER_MAX_SITES - 1) + 1;
+	i = start;
+	do {
+		struct alloc_site *site = &tracker->sites[i];
+		const char *cur = atomic_load_explicit(&site->name, memory_order_acquire);
+		
+		if (cur == name)
+			return i;
+		if (!cur) {
+			const char *expected = NULL;
+			
+			/* The subsystem goes first, readers take it once the name is set */
+			if (!atomic_load_explicit(&site->subsystem, memory_order_relaxed))
+				atomic_store_explicit(&site->subsystem,
+				                      subsystem ? subsystem : "unknown",
+				                      memory_order_relaxed);
+			if (atomic_compare_exchange_strong_explicit(&site->name, &expected, name,
+			                                            memory_order_release,
+			                                            memory_order_acquire) ||
+			    expected == name)
+				return i;
+		}
+		i = i % (MEMORY_TRACKER_MAX_SITES - 1) + 1;
+	} while (i != start);
+	
+	return 0;
+}
+
+/* Insert into a stripe, lock held. Returns 1 if added, 0 if an entry for
+ * the same pointer was replaced and copied to old, -1 without memory. */
+static int stripe_insert(struct alloc_stripe *stripe, uint64_t hash,
+                         const struct alloc_entry *entry, struct alloc_entry *old)
+{
+	size_t i;
+	
+	/* At most half full */
+	if ((stripe->count + 1) * 2 > stripe->mask + 1 || !stripe->entries) {
+		size_t slots = stripe->entries ? (stripe->mask + 1) * 2 : MT_INITIAL_SLOTS;
+		struct alloc_entry *entries = calloc(slots, sizeof(*entries));
+		
+		if (!entries)
+			return -1;
+		
+		for (i = 0; stripe->entries && i <= stripe->mask; i++) {
+			size_t j;
+			
+			if (!stripe->entries[i].ptr)
+				continue;
+			for (j = hash_ptr(stripe->entries[i].ptr) & (slots - 1); entries[j].ptr;
+			     j = (j + 1) & (slots - 1))
+				;
+			entries[j] = stripe->entries[i];
+		}
+		free(stripe->entries);
+		stripe->entries = entries;
+		stripe->mask = slots - 1;
+	}
+	
+	for (i = hash & stripe->mask; stripe->entries[i].ptr; i = (i + 1) & stripe->mask) {
+		/* Same pointer twice, the first free was missed: replace it */
+		if (stripe->entries[i].ptr == entry->ptr) {
+			*old = stripe->entries[i];
+			stripe->entries[i] = *entry;
+			return 0;
+		}
+	}
+	stripe->entries[i] = *entry;
+	stripe->count++;
+	return 1;
+}
+
+/* Remove from a stripe, lock held. Returns whether ptr was there. */
+static bool stripe_remove(struct alloc_stripe *stripe, uint64_t hash, uintptr_t ptr,
+                          struct alloc_entry *removed)
+{
+	size_t i, j;
+	
+	if (!stripe->entries)
+		return false;
+	
+	for (i = hash & stripe->mask; stripe->entries[i].ptr != ptr; i = (i + 1) & stripe->mask)
+		if (!stripe->entries[i].ptr)
+			return false;
+	
+	*removed = stripe->entries[i];
+	stripe->count--;
+	
+	/* Shift back what would no longer be found past the hole */
+	for (j = i;;) {
+		size_t home;
+		
+		j = (j + 1) & stripe->mask;
+		if (!stripe->entries[j].ptr)
+			break;
+		home = hash_ptr(stripe->entries[j].ptr) & stripe->mask;
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+		stripe->entries[i] = stripe->entries[j];
+		i = j;
+	}
+	stripe->entries[i].ptr = 0;
+	return true;
+}
+
 struct memory_tracker *memory_tracker_create(bool enable_tracking)
 {
 	struct memory_tracker *tracker;
+	int i;
 	
 	tracker = calloc(1, sizeof(*tracker));
 	if (!tracker)
@@ -49,13 +243,28 @@ struct memory_tracker *memory_tracker_create(bool enable_tracking)
 	tracker->tracking_enabled = enable_tracking;
 	
 	if (enable_tracking) {
-		if (pthread_mutex_init(&tracker->mutex, NULL) != 0) {
-			free(tracker);
-			return NULL;
+		if (posix_memalign((void **)&tracker->stripes, 64,
+		                   MT_STRIPES * sizeof(*tracker->stripes)) != 0)
+			goto err_free;
+		memset(tracker->stripes, 0, MT_STRIPES * sizeof(*tracker->stripes));
+		
+		tracker->sites = calloc(MEMORY_TRACKER_MAX_SITES, sizeof(*tracker->sites));
+		if (!tracker->sites)
+			goto err_stripes;
+		atomic_init(&tracker->sites[0].subsystem, "unknown");
+		
+		for (i = 0; i < MT_STRIPES; i++) {
+			if (pthread_mutex_init(&tracker->stripes[i].lock, NULL) != 0) {
+				while (--i >= 0)
+					pthread_mutex_destroy(&tracker->stripes[i].lock);
+				goto err_sites;
+			}
 		}
 	}
 	
 	/* Initialize atomics */
+	atomic_init(&tracker->sample_interval, 0);
+	atomic_init(&tracker->tracked, 0);
 	atomic_init(&tracker->rss, 0);
 	atomic_init(&tracker->vms, 0);
 	atomic_init(&tracker->peak_rss, 0);
@@ -70,25 +279,30 @@ struct memory_tracker *memory_tracker_create(bool enable_tracking)
 	memory_tracker_update_system_stats(tracker);
 	
 	return tracker;
+	
+err_sites:
+	free(tracker->sites);
+err_stripes:
+	free(tracker->stripes);
+err_free:
+	free(tracker);
+	return NULL;
 }
 
 void memory_tracker_destroy(struct memory_tracker *tracker)
 {
-	struct alloc_entry *entry, *next;
+	int i;
 	
 	if (!tracker)
 		return;
 	
 	if (tracker->tracking_enabled) {
-		/* Free allocation entries */
-		entry = tracker->allocations;
-		while (entry) {
-			next = entry->next;
-			free(entry);
-			entry = next;
+		for (i = 0; i < MT_STRIPES; i++) {
+			free(tracker->stripes[i].entries);
+			pthread_mutex_destroy(&tracker->stripes[i].lock);
 		}
-		
-		pthread_mutex_destroy(&tracker->mutex);
+		free(tracker->stripes);
+		free(tracker->sites);
 	}
 	
 	free(tracker);
@@ -96,8 +310,29 @@ void memory_tracker_destroy(struct memory_tracker *tracker)
 
 void memory_tracker_alloc(struct memory_tracker *tracker, size_t size, void *ptr)
 {
-	struct alloc_entry *entry;
-	size_t current, peak;
+	memory_tracker_alloc_at(tracker, size, ptr, NULL, NULL);
+}
+
+/* Take an entry off the figures */
+static void untrack(struct memory_tracker *tracker, const struct alloc_entry *entry)
+{
+	struct alloc_site *s = &tracker->sites[entry->site];
+	
+	atomic_fetch_add_explicit(&tracker->freed, entry->weight, memory_order_relaxed);
+	atomic_fetch_sub_explicit(&tracker->current_usage, entry->weight, memory_order_relaxed);
+	atomic_fetch_sub_explicit(&s->live_bytes, entry->weight, memory_order_relaxed);
+	atomic_fetch_sub_explicit(&s->live_count, entry->count, memory_order_relaxed);
+}
+
+void memory_tracker_alloc_at(struct memory_tracker *tracker, size_t size, void *ptr,
+                             const char *subsystem, const char *site)
+{
+	struct alloc_entry entry, old;
+	struct alloc_stripe *stripe;
+	struct alloc_site *s;
+	size_t interval, current, peak;
+	uint64_t hash;
+	int ret;
 	
 	if (!tracker || !ptr)
 		return;
@@ -105,8 +340,46 @@ void memory_tracker_alloc(struct memory_tracker *tracker, size_t size, void *ptr
 	/* Update statistics */
 	atomic_fetch_add_explicit(&tracker->allocated, size, memory_order_relaxed);
 	atomic_fetch_add_explicit(&tracker->alloc_count, 1, memory_order_relaxed);
-	current = atomic_fetch_add_explicit(&tracker->current_usage, size,
-	                                    memory_order_relaxed) + size;
+	
+	entry.weight = size;
+	entry.count = 1;
+	
+	/* Track allocation if enabled */
+	if (tracker->tracking_enabled) {
+		/* Sampled with probability size / interval */
+		interval = atomic_load_explicit(&tracker->sample_interval, memory_order_relaxed);
+		if (interval > size) {
+			if (sample_random() % interval >= size)
+				return;
+			entry.weight = interval;
+			entry.count = size ? interval / size : interval;
+		}
+		
+		entry.ptr = (uintptr_t)ptr;
+		entry.site = find_site(tracker, site, subsystem);
+		
+		hash = hash_ptr(entry.ptr);
+		stripe = ptr_stripe(tracker, hash);
+		pthread_mutex_lock(&stripe->lock);
+		ret = stripe_insert(stripe, hash, &entry, &old);
+		pthread_mutex_unlock(&stripe->lock);
+		
+		if (ret < 0)
+			return;
+		if (ret == 0)
+			untrack(tracker, &old);
+		else
+			atomic_fetch_add_explicit(&tracker->tracked, 1, memory_order_relaxed);
+		
+		s = &tracker->sites[entry.site];
+		atomic_fetch_add_explicit(&s->live_bytes, entry.weight, memory_order_relaxed);
+		atomic_fetch_add_explicit(&s->live_count, entry.count, memory_order_relaxed);
+		atomic_fetch_add_explicit(&s->total_bytes, entry.weight, memory_order_relaxed);
+		atomic_fetch_add_explicit(&s->total_count, entry.count, memory_order_relaxed);
+	}
+	
+	current = atomic_fetch_add_explicit(&tracker->current_usage, entry.weight,
+	                                    memory_order_relaxed) + entry.weight;
 	
 	/* Update peak usage */
 	peak = atomic_load_explicit(&tracker->peak_usage, memory_order_relaxed);
@@ -116,59 +389,35 @@ void memory_tracker_alloc(struct memory_tracker *tracker, size_t size, void *ptr
 		                                          memory_order_relaxed))
 			break;
 	}
-	
-	/* Track allocation if enabled */
-	if (tracker->tracking_enabled) {
-		entry = malloc(sizeof(*entry));
-		if (entry) {
-			entry->ptr = ptr;
-			entry->size = size;
-			
-			pthread_mutex_lock(&tracker->mutex);
-			entry->next = tracker->allocations;
-			tracker->allocations = entry;
-			pthread_mutex_unlock(&tracker->mutex);
-		}
-	}
 }
 
 void memory_tracker_free(struct memory_tracker *tracker, void *ptr)
 {
-	struct alloc_entry *entry, *prev;
-	size_t size = 0;
+	struct alloc_entry entry;
+	struct alloc_stripe *stripe;
+	uint64_t hash;
+	bool found;
 	
 	if (!tracker || !ptr)
 		return;
 	
+	atomic_fetch_add_explicit(&tracker->free_count, 1, memory_order_relaxed);
+	
 	/* Find and remove allocation entry if tracking */
-	if (tracker->tracking_enabled) {
-		pthread_mutex_lock(&tracker->mutex);
-		
-		prev = NULL;
-		for (entry = tracker->allocations; entry; entry = entry->next) {
-			if (entry->ptr == ptr) {
-				size = entry->size;
-				
-				if (prev)
-					prev->next = entry->next;
-				else
-					tracker->allocations = entry->next;
-				
-				free(entry);
-				break;
-			}
-			prev = entry;
-		}
-		
-		pthread_mutex_unlock(&tracker->mutex);
-	}
+	if (!tracker->tracking_enabled)
+		return;
+	
+	hash = hash_ptr((uintptr_t)ptr);
+	stripe = ptr_stripe(tracker, hash);
+	pthread_mutex_lock(&stripe->lock);
+	found = stripe_remove(stripe, hash, (uintptr_t)ptr, &entry);
+	pthread_mutex_unlock(&stripe->lock);
 	
 	/* Update statistics */
-	if (size > 0) {
-		atomic_fetch_add_explicit(&tracker->freed, size, memory_order_relaxed);
-		atomic_fetch_sub_explicit(&tracker->current_usage, size, memory_order_relaxed);
+	if (found) {
+		atomic_fetch_sub_explicit(&tracker->tracked, 1, memory_order_relaxed);
+		untrack(tracker, &entry);
 	}
-	atomic_fetch_add_explicit(&tracker->free_count, 1, memory_order_relaxed);
 }
 
 bool memory_tracker_get_stats(struct memory_tracker *tracker,
@@ -186,10 +435,125 @@ bool memory_tracker_get_stats(struct memory_tracker *tracker,
 	stats->peak_usage = atomic_load_explicit(&tracker->peak_usage, memory_order_relaxed);
 	stats->alloc_count = atomic_load_explicit(&tracker->alloc_count, memory_order_relaxed);
 	stats->free_count = atomic_load_explicit(&tracker->free_count, memory_order_relaxed);
+	stats->tracked = atomic_load_explicit(&tracker->tracked, memory_order_relaxed);
+	stats->sample_interval = atomic_load_explicit(&tracker->sample_interval,
+	                                              memory_order_relaxed);
 	
 	return true;
 }
 
+void memory_tracker_set_sampling(struct memory_tracker *tracker, size_t interval)
+{
+	if (!tracker)
+		return;
+	
+	/* Entries keep their own weight, so this can change at any time */
+	atomic_store_explicit(&tracker->sample_interval, interval, memory_order_relaxed);
+}
+
+static void load_site(struct memory_tracker *tracker, uint32_t i,
+                      struct memory_site_stats *out)
+{
+	struct alloc_site *site = &tracker->sites[i];
+	
+	out->site = atomic_load_explicit(&site->name, memory_order_acquire);
+	out->subsystem = atomic_load_explicit(&site->subsystem, memory_order_relaxed);
+	out->live_bytes = atomic_load_explicit(&site->live_bytes, memory_order_relaxed);
+	out->live_count = atomic_load_explicit(&site->live_count, memory_order_relaxed);
+	out->total_bytes = atomic_load_explicit(&site->total_bytes, memory_order_relaxed);
+	out->total_count = atomic_load_explicit(&site->total_count, memory_order_relaxed);
+}
+
+static int compare_live(const void *a, const void *b)
+{
+	const struct memory_site_stats *sa = a, *sb = b;
+	
+	if (sa->live_bytes != sb->live_bytes)
+		return sa->live_bytes < sb->live_bytes ? 1 : -1;
+	return sa->total_bytes < sb->total_bytes ? 1 : sa->total_bytes > sb->total_bytes ? -1 : 0;
+}
+
+/* Snapshot of every site that allocated, sorted, count returned */
+static int snapshot_sites(struct memory_tracker *tracker, struct memory_site_stats *all)
+{
+	int count = 0;
+	
+	for (uint32_t i = 0; i < MEMORY_TRACKER_MAX_SITES; i++) {
+		load_site(tracker, i, &all[count]);
+		if (i == 0)
+			all[count].site = "unknown";
+		if (all[count].site && (all[count].total_count > 0 || all[count].live_count > 0))
+			count++;
+	}
+	qsort(all, count, sizeof(*all), compare_live);
+	return count;
+}
+
+int memory_tracker_get_sites(struct memory_tracker *tracker,
+                             struct memory_site_stats *sites, int max_sites)
+{
+	struct memory_site_stats *all;
+	int count;
+	
+	if (!tracker || !sites || max_sites <= 0 || !tracker->tracking_enabled)
+		return 0;
+	
+	all = malloc(MEMORY_TRACKER_MAX_SITES * sizeof(*all));
+	if (!all)
+		return 0;
+	
+	count = snapshot_sites(tracker, all);
+	if (count > max_sites)
+		count = max_sites;
+	memcpy(sites, all, count * sizeof(*sites));
+	
+	free(all);
+	return count;
+}
+
+int memory_tracker_get_subsystems(struct memory_tracker *tracker,
+                                  struct memory_site_stats *subsystems,
+                                  int max_subsystems)
+{
+	struct memory_site_stats *all;
+	int count, n = 0;
+	
+	if (!tracker || !subsystems || max_subsystems <= 0 || !tracker->tracking_enabled)
+		return 0;
+	
+	all = malloc(MEMORY_TRACKER_MAX_SITES * sizeof(*all));
+	if (!all)
+		return 0;
+	
+	/* Sites are few, folding them by name is quadratic but cheap */
+	count = snapshot_sites(tracker, all);
+	for (int i = 0; i < count; i++) {
+		int j;
+		
+		for (j = 0; j < n; j++)
+			if (strcmp(all[j].subsystem, all[i].subsystem) == 0)
+				break;
+		if (j == n) {
+			all[n] = all[i];
+			all[n].site = NULL;
+			n++;
+			continue;
+		}
+		all[j].live_bytes += all[i].live_bytes;
+		all[j].live_count += all[i].live_count;
+		all[j].total_bytes += all[i].total_bytes;
+		all[j].total_count += all[i].total_count;
+	}
+	qsort(all, n, sizeof(*all), compare_live);
+	
+	if (n > max_subsystems)
+		n = max_subsystems;
+	memcpy(subsystems, all, n * sizeof(*subsystems));
+	
+	free(all);
+	return n;
+}
+
 bool memory_tracker_update_system_stats(struct memory_tracker *tracker)
 {
 	FILE *fp;
@@ -240,11 +604,21 @@ void memory_tracker_reset_stats(struct memory_tracker *tracker)
 	atomic_store_explicit(&tracker->freed, 0, memory_order_relaxed);
 	atomic_store_explicit(&tracker->alloc_count, 0, memory_order_relaxed);
 	atomic_store_explicit(&tracker->free_count, 0, memory_order_relaxed);
+	
+	/* Live figures describe what is allocated and stay */
+	if (tracker->tracking_enabled) {
+		for (int i = 0; i < MEMORY_TRACKER_MAX_SITES; i++) {
+			atomic_store_explicit(&tracker->sites[i].total_bytes, 0, memory_order_relaxed);
+			atomic_store_explicit(&tracker->sites[i].total_count, 0, memory_order_relaxed);
+		}
+	}
 }
 
 void memory_tracker_dump(struct memory_tracker *tracker, int fd)
 {
+	struct memory_site_stats top[10];
 	struct memory_stats stats;
+	int i, n;
 	
 	if (!tracker)
 		return;
@@ -266,6 +640,23 @@ void memory_tracker_dump(struct memory_tracker *tracker, int fd)
 		dprintf(fd, "  Peak usage:    %zu bytes (%.2f MB)\n", stats.peak_usage, stats.peak_usage / 1024.0 / 1024.0);
 		dprintf(fd, "  Alloc count:   %lu\n", stats.alloc_count);
 		dprintf(fd, "  Free count:    %lu\n", stats.free_count);
+		if (stats.sample_interval)
+			dprintf(fd, "  Sampled:       1 per %zu bytes, %lu live samples\n",
+			        stats.sample_interval, stats.tracked);
+		
+		n = memory_tracker_get_subsystems(tracker, top, 10);
+		if (n > 0)
+			dprintf(fd, "\nBy Subsystem (live bytes, live allocations):\n");
+		for (i = 0; i < n; i++)
+			dprintf(fd, "  %-24s %12zu %10zu\n", top[i].subsystem,
+			        top[i].live_bytes, top[i].live_count);
+		
+		n = memory_tracker_get_sites(tracker, top, 10);
+		if (n > 0)
+			dprintf(fd, "\nTop Call Sites (live bytes, live allocations):\n");
+		for (i = 0; i < n; i++)
+			dprintf(fd, "  %-40s %12zu %10zu  [%s]\n", top[i].site,
+			        top[i].live_bytes, top[i].live_count, top[i].subsystem);
 	}
 	
 	dprintf(fd, "========================\n");
@@ -0,0 +1,211 @@
+/* name_table.c - Constant-time lookups between IDs and their names
+ *
+ * Both directions map to slots holding an entry number plus one, 0 for
+ * a free slot. IDs spanning at most ID_DENSE_FACTOR times the number of
+ * entries index their slots directly, others hash into a power of two
+ * of slots at most half full, probed linearly. Names hash the same way
+ * with FNV-1a.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "name_table.h"
+
+#define ID_DENSE_FACTOR 4
+
+struct name_index {
+	uint32_t id_min;                /* ID of id_slots[0] when dense */
+	bool id_dense;
+	size_t id_size;
+	uint32_t *id_slots;
+	size_t name_mask;
+	uint32_t *name_slots;
+	uint32_t slots[];
+};
+
+static inline uint32_t hash_id(uint32_t id)
+{
+	id ^= id >> 16;
+	id *= 0x85ebca6bU;
+	id ^= id >> 13;
+	id *= 0xc2b2ae35U;
+	id ^= id >> 16;
+	return id;
+}
+
+static inline uint32_t hash_name(const char *name, size_t len)
+{
+	uint32_t hash = 2166136261U;
+	
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static inline bool name_equal(const char *entry, const char *name, size_t len)
+{
+	return strncmp(entry, name, len) == 0 && entry[len] == '\0';
+}
+
+/* Smallest power of two of slots at most half full */
+static size_t hash_size(size_t count)
+{
+	size_t size = 8;
+	
+	while (size < 2 * count)
+		size <<= 1;
+	return size;
+}
+
+static struct name_index *build_index(const struct name_table *table)
+{
+	struct name_index *index;
+	uint32_t id_min = UINT32_MAX, id_max = 0;
+	size_t id_size, name_size;
+	bool dense;
+	
+	for (size_t i = 0; i < table->count; i++) {
+		if (table->entries[i].id < id_min)
+			id_min = table->entries[i].id;
+		if (table->entries[i].id > id_max)
+			id_max = table->entries[i].id;
+	}
+	
+	dense = (uint64_t)id_max - id_min < (uint64_t)ID_DENSE_FACTOR * table->count;
+	id_size = dense ? (size_t)(id_max - id_min) + 1 : hash_size(table->count);
+	name_size = hash_size(table->count);
+	
+	index = calloc(1, sizeof(*index) + (id_size + name_size) * sizeof(uint32_t));
+	if (!index)
+		return NULL;
+	
+	index->id_min = id_min;
+	index->id_dense = dense;
+	index->id_size = id_size;
+	index->id_slots = index->slots;
+	index->name_mask = name_size - 1;
+	index->name_slots = index->slots + id_size;
+	
+	for (size_t i = 0; i < table->count; i++) {
+		const struct name_table_entry *entry = &table->entries[i];
+		size_t slot;
+		bool listed = false;
+		
+		if (dense) {
+			slot = entry->id - id_min;
+			listed = index->id_slots[slot] != 0;
+		} else {
+			slot = hash_id(entry->id) & (id_size - 1);
+			while (index->id_slots[slot]) {
+				if (table->entries[index->id_slots[slot] - 1].id == entry->id) {
+					listed = true;
+					break;
+				}
+				slot = (slot + 1) & (id_size - 1);
+			}
+		}
+		if (!listed)
+			index->id_slots[slot] = (uint32_t)i + 1;
+		
+		slot = hash_name(entry->name, strlen(entry->name)) & index->name_mask;
+		while (index->name_slots[slot])
+			slot = (slot + 1) & index->name_mask;
+		index->name_slots[slot] = (uint32_t)i + 1;
+	}
+	
+	return index;
+}
+
+/* Get the index, building it on first use */
+static struct name_index *get_index(struct name_table *table)
+{
+	struct name_index *index = atomic_load_explicit(&table->index, memory_order_acquire);
+	struct name_index *expected = NULL;
+	
+	if (index)
+		return index;
+	
+	index = build_index(table);
+	if (!index)
+		return NULL;
+	
+	/* Another thread may have built one meanwhile */
+	if (!atomic_compare_exchange_strong_explicit(&table->index, &expected, index,
+	                                             memory_order_acq_rel,
+	                                             memory_order_acquire)) {
+		free(index);
+		return expected;
+	}
+	return index;
+}
+
+/* Look up the name of an ID */
+const char *name_table_name(struct name_table *table, uint32_t id)
+{
+	struct name_index *index;
+	size_t slot;
+	
+	if (!table)
+		return NULL;
+	
+	index = get_index(table);
+	if (!index) {
+		for (size_t i = 0; i < table->count; i++) {
+			if (table->entries[i].id == id)
+				return table->entries[i].name;
+		}
+		return NULL;
+	}
+	
+	if (index->id_dense) {
+		if (id < index->id_min || id - index->id_min >= index->id_size)
+			return NULL;
+		slot = index->id_slots[id - index->id_min];
+		return slot ? table->entries[slot - 1].name : NULL;
+	}
+	
+	for (slot = hash_id(id) & (index->id_size - 1); index->id_slots[slot];
+	     slot = (slot + 1) & (index->id_size - 1)) {
+		const struct name_table_entry *entry = &table->entries[index->id_slots[slot] - 1];
+		
+		if (entry->id == id)
+			return entry->name;
+	}
+	return NULL;
+}
+
+/* Look up the ID of a name */
+bool name_table_find(struct name_table *table, const char *name, size_t len,
+                     uint32_t *id)
+{
+	struct name_index *index;
+	
+	if (!table || !name)
+		return false;
+	
+	index = get_index(table);
+	if (!index) {
+		for (size_t i = 0; i < table->count; i++) {
+			if (name_equal(table->entries[i].name, name, len)) {
+				if (id)
+					*id = table->entries[i].id;
+				return true;
+			}
+		}
+		return false;
+	}
+	
+	for (size_t slot = hash_name(name, len) & index->name_mask; index->name_slots[slot];
+	     slot = (slot + 1) & index->name_mask) {
+		const struct name_table_entry *entry = &table->entries[index->name_slots[slot] - 1];
+		
+		if (name_equal(entry->name, name, len)) {
+			if (id)
+				*id = entry->id;
+			return true;
+		}
+	}
+	return false;
+}
@@ -7,30 +7,63 @@
 #include <time.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/inotify.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <net/if.h>
 
 #include "namespace_tracker.h"
+#include "id_table.h"
 
-#define MAX_CACHED_NAMESPACES 256
 #define NETNS_RUN_DIR "/var/run/netns"
 #define PROC_NET_NS_PATH "/proc/%d/ns/net"
 
+#define DEFAULT_RECONCILE_INTERVAL 60   /* Seconds between full rescans */
+#define MIN_RECONCILE_INTERVAL 5        /* Seconds, for rescans asked for by events */
+
 /* Namespace cache entry */
 struct ns_cache_entry {
-	ino_t nsid;
+	struct id_slot slot;             /* Key is the namespace inode */
 	char name[NAMESPACE_NAME_MAX];
+	pid_t pid;
 	time_t last_update;
+	uint32_t generation;             /* Full scan that last saw it */
+	uint32_t named_generation;       /* Named scan that last saw it */
+	int named;                       /* Name from NETNS_RUN_DIR */
 	int valid;
 };
 
+/* Interface cache entry */
+struct if_cache_entry {
+	struct id_slot slot;             /* Key is the interface index */
+	char ifname[IFNAMSIZ];
+	ino_t nsid;
+};
+
 struct namespace_tracker {
-	struct ns_cache_entry cache[MAX_CACHED_NAMESPACES];
-	int cache_count;
+	struct id_table namespaces;      /* struct ns_cache_entry by inode */
+	struct id_table interfaces;      /* struct if_cache_entry by ifindex */
+	ino_t self_nsid;
+	uint32_t generation;
+	uint32_t named_generation;
 	time_t last_scan;
+	unsigned int reconcile_interval;
+	int reconcile_due;               /* A netns event asked for a rescan */
+	int named_dirty;                 /* NETNS_RUN_DIR changed */
+	int inotify_fd;
 };
 
+/* Get namespace inode from a file descriptor or path */
+static ino_t get_namespace_inode(const char *path)
+{
+	struct stat st;
+	
+	if (stat(path, &st) < 0)
+		return 0;
+	
+	return st.st_ino;
+}
+
 struct namespace_tracker *namespace_tracker_init(void)
 {
 	struct namespace_tracker *tracker;
@@ -39,23 +72,27 @@ struct namespace_tracker *namespace_tracker_init(void)
 	if (!tracker)
 		return NULL;
 	
+	tracker->namespaces = (struct id_table)ID_TABLE_INIT(struct ns_cache_entry);
+	tracker->interfaces = (struct id_table)ID_TABLE_INIT(struct if_cache_entry);
+	tracker->reconcile_interval = DEFAULT_RECONCILE_INTERVAL;
+	tracker->self_nsid = get_namespace_inode("/proc/self/ns/net");
+	
+	/* Named namespaces come and go with files in NETNS_RUN_DIR. Without
+	 * the directory they are only found by the periodic rescan. */
+	tracker->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (tracker->inotify_fd >= 0 &&
+	    inotify_add_watch(tracker->inotify_fd, NETNS_RUN_DIR,
+	                      IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) < 0) {
+		close(tracker->inotify_fd);
+		tracker->inotify_fd = -1;
+	}
+	
 	/* Initial scan of namespaces */
 	namespace_tracker_update_cache(tracker);
 	
 	return tracker;
 }
 
-/* Get namespace inode from a file descriptor or path */
-static ino_t get_namespace_inode(const char *path)
-{
-	struct stat st;
-	
-	if (stat(path, &st) < 0)
-		return 0;
-	
-	return st.st_ino;
-}
-
 /* Scan /var/run/netns for named namespaces */
 static void scan_named_namespaces(struct namespace_tracker *tracker)
 {
@@ -63,47 +100,62 @@ static void scan_named_namespaces(struct namespace_tracker *tracker)
 	struct dirent *entry;
 	char path[512];
 	ino_t nsid;
-	int idx;
+	size_t i;
+	
+	tracker->named_generation++;
+	tracker->named_dirty = 0;
 	
 	dir = opendir(NETNS_RUN_DIR);
-	if (!dir)
-		return;  /* Directory doesn't exist or no permission */
+	if (dir) {
+		while ((entry = readdir(dir)) != NULL) {
+			struct ns_cache_entry *ns;
+			int created;
+			
+			if (entry->d_name[0] == '.')
+				continue;
+			
+			snprintf(path, sizeof(path), "%s/%s", NETNS_RUN_DIR, entry->d_name);
+			nsid = get_namespace_inode(path);
+			
+			if (nsid == 0)
+				continue;
+			
+			ns = id_table_get(&tracker->namespaces, nsid, &created);
+			if (!ns)
+				continue;
+			if (created)
+				ns->last_update = time(NULL);
+			
+			/* Update name if changed */
+			strncpy(ns->name, entry->d_name, NAMESPACE_NAME_MAX - 1);
+			ns->name[NAMESPACE_NAME_MAX - 1] = '\0';
+			ns->named = 1;
+			ns->named_generation = tracker->named_generation;
+			ns->generation = tracker->generation;
+			ns->valid = 1;
+		}
+		closedir(dir);
+	}
 	
-	while ((entry = readdir(dir)) != NULL) {
-		if (entry->d_name[0] == '.')
-			continue;
+	/* Names that went away fall back to the PID, or go with their namespace */
+	for (i = 0; i < tracker->namespaces.size; ) {
+		struct ns_cache_entry *ns = (struct ns_cache_entry *)id_table_slot(&tracker->namespaces, i);
 		
-		snprintf(path, sizeof(path), "%s/%s", NETNS_RUN_DIR, entry->d_name);
-		nsid = get_namespace_inode(path);
-		
-		if (nsid == 0)
+		if (!ns->slot.used || !ns->named ||
+		    ns->named_generation == tracker->named_generation) {
+			i++;
 			continue;
-		
-		/* Check if already in cache */
-		int found = 0;
-		for (idx = 0; idx < tracker->cache_count; idx++) {
-			if (tracker->cache[idx].nsid == nsid) {
-				/* Update name if changed */
-				strncpy(tracker->cache[idx].name, entry->d_name, NAMESPACE_NAME_MAX - 1);
-				tracker->cache[idx].name[NAMESPACE_NAME_MAX - 1] = '\0';
-				tracker->cache[idx].valid = 1;
-				found = 1;
-				break;
-			}
 		}
 		
-		/* Add new entry */
-		if (!found && tracker->cache_count < MAX_CACHED_NAMESPACES) {
-			idx = tracker->cache_count++;
-			tracker->cache[idx].nsid = nsid;
-			strncpy(tracker->cache[idx].name, entry->d_name, NAMESPACE_NAME_MAX - 1);
-			tracker->cache[idx].name[NAMESPACE_NAME_MAX - 1] = '\0';
-			tracker->cache[idx].last_update = time(NULL);
-			tracker->cache[idx].valid = 1;
+		if (ns->pid > 0) {
+			ns->named = 0;
+			snprintf(ns->name, NAMESPACE_NAME_MAX, "pid-%d", ns->pid);
+			i++;
+		} else {
+			/* Re-check i, an entry may have moved in */
+			id_table_remove(&tracker->namespaces, ns);
 		}
 	}
-	
-	closedir(dir);
 }
 
 /* Scan /proc for process namespaces */
@@ -114,13 +166,15 @@ static void scan_proc_namespaces(struct namespace_tracker *tracker)
 	char path[512];
 	ino_t nsid;
 	pid_t pid;
-	int idx;
 	
 	dir = opendir("/proc");
 	if (!dir)
 		return;
 	
 	while ((entry = readdir(dir)) != NULL) {
+		struct ns_cache_entry *ns;
+		int created;
+		
 		/* Check if directory name is a number (PID) */
 		if (entry->d_type != DT_DIR)
 			continue;
@@ -135,68 +189,265 @@ static void scan_proc_namespaces(struct namespace_tracker *tracker)
 		if (nsid == 0)
 			continue;
 		
-		/* Check if already in cache */
-		int found = 0;
-		for (idx = 0; idx < tracker->cache_count; idx++) {
-			if (tracker->cache[idx].nsid == nsid) {
-				found = 1;
-				/* If no name set, use PID */
-				if (tracker->cache[idx].name[0] == '\0') {
-					snprintf(tracker->cache[idx].name, NAMESPACE_NAME_MAX, "pid-%d", pid);
-				}
-				break;
-			}
-		}
+		ns = id_table_get(&tracker->namespaces, nsid, &created);
+		if (!ns)
+			continue;
 		
 		/* Add new entry with PID-based name */
-		if (!found && tracker->cache_count < MAX_CACHED_NAMESPACES) {
-			idx = tracker->cache_count++;
-			tracker->cache[idx].nsid = nsid;
-			snprintf(tracker->cache[idx].name, NAMESPACE_NAME_MAX, "pid-%d", pid);
-			tracker->cache[idx].last_update = time(NULL);
-			tracker->cache[idx].valid = 1;
+		if (created) {
+			snprintf(ns->name, NAMESPACE_NAME_MAX, "pid-%d", pid);
+			ns->last_update = time(NULL);
+			ns->valid = 1;
 		}
+		if (ns->pid <= 0)
+			ns->pid = pid;
+		ns->generation = tracker->generation;
 	}
 	
 	closedir(dir);
 }
 
+/* Full rescan, dropping the namespaces neither scan saw */
 void namespace_tracker_update_cache(struct namespace_tracker *tracker)
 {
+	size_t i;
+	
 	if (!tracker)
 		return;
 	
+	tracker->generation++;
+	
 	/* Scan named namespaces first (they have priority) */
 	scan_named_namespaces(tracker);
 	
 	/* Then scan process namespaces */
 	scan_proc_namespaces(tracker);
 	
+	for (i = 0; i < tracker->namespaces.size; ) {
+		struct ns_cache_entry *ns = (struct ns_cache_entry *)id_table_slot(&tracker->namespaces, i);
+		
+		if (ns->slot.used && ns->generation != tracker->generation)
+			id_table_remove(&tracker->namespaces, ns);  /* Re-check i */
+		else
+			i++;
+	}
+	
+	tracker->reconcile_due = 0;
 	tracker->last_scan = time(NULL);
 }
 
+/* Catch up with events before a lookup: rescan NETNS_RUN_DIR if it
+ * changed, everything if the reconciliation is due */
+static void namespace_tracker_refresh(struct namespace_tracker *tracker)
+{
+	time_t age;
+	
+	namespace_tracker_process_events(tracker);
+	
+	age = time(NULL) - tracker->last_scan;
+	if (age >= (time_t)tracker->reconcile_interval ||
+	    (tracker->reconcile_due && age >= MIN_RECONCILE_INTERVAL)) {
+		namespace_tracker_update_cache(tracker);
+		return;
+	}
+	
+	if (tracker->named_dirty)
+		scan_named_namespaces(tracker);
+}
+
+int namespace_tracker_get_fd(struct namespace_tracker *tracker)
+{
+	if (!tracker)
+		return -1;
+	
+	return tracker->inotify_fd;
+}
+
+void namespace_tracker_process_events(struct namespace_tracker *tracker)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	
+	if (!tracker || tracker->inotify_fd < 0)
+		return;
+	
+	/* The next lookup rescans the directory. The namespace is bound to
+	 * its file only after the file is created, so it is not read here. */
+	while ((len = read(tracker->inotify_fd, buf, sizeof(buf))) > 0)
+		tracker->named_dirty = 1;
+}
+
+void namespace_tracker_set_reconcile_interval(struct namespace_tracker *tracker,
+                                              unsigned int seconds)
+{
+	if (!tracker)
+		return;
+	
+	tracker->reconcile_interval = seconds ? seconds : DEFAULT_RECONCILE_INTERVAL;
+}
+
+int namespace_tracker_handle_msg(struct namespace_tracker *tracker,
+                                 const struct nlmsghdr *nlh)
+{
+	struct if_cache_entry *link;
+	struct ifinfomsg *ifi;
+	struct rtattr *rta;
+	int rtalen;
+	int created;
+	
+	if (!tracker || !nlh)
+		return -1;
+	
+	switch (nlh->nlmsg_type) {
+	case RTM_NEWNSID:
+	case RTM_DELNSID:
+		/* The events carry the peer ID, not the inode, so rescan */
+		tracker->reconcile_due = 1;
+		return 0;
+		
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		break;
+		
+	default:
+		return 0;
+	}
+	
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+		return -1;
+	
+	ifi = (struct ifinfomsg *)NLMSG_DATA(nlh);
+	if (ifi->ifi_index <= 0)
+		return -1;
+	
+	if (nlh->nlmsg_type == RTM_DELLINK) {
+		link = id_table_find(&tracker->interfaces, (uint64_t)ifi->ifi_index);
+		if (!link)
+			return 0;
+		id_table_remove(&tracker->interfaces, link);
+		return 1;
+	}
+	
+	link = id_table_get(&tracker->interfaces, (uint64_t)ifi->ifi_index, &created);
+	if (!link)
+		return -1;
+	
+	/* Links are in the namespace of the socket unless moved by PID */
+	link->nsid = tracker->self_nsid;
+	
+	rta = IFLA_RTA(ifi);
+	rtalen = IFLA_PAYLOAD(nlh);
+	while (RTA_OK(rta, rtalen)) {
+		if (rta->rta_type == IFLA_IFNAME && RTA_PAYLOAD(rta) > 0) {
+			size_t n = RTA_PAYLOAD(rta);
+			
+			if (n >= sizeof(link->ifname))
+				n = sizeof(link->ifname) - 1;
+			memcpy(link->ifname, RTA_DATA(rta), n);
+			link->ifname[n] = '\0';
+		} else if (rta->rta_type == IFLA_NET_NS_PID && RTA_PAYLOAD(rta) >= sizeof(pid_t)) {
+			char path[256];
+			pid_t pid;
+			ino_t nsid;
+			
+			memcpy(&pid, RTA_DATA(rta), sizeof(pid));
+			snprintf(path, sizeof(path), PROC_NET_NS_PATH, pid);
+			nsid = get_namespace_inode(path);
+			if (nsid != 0)
+				link->nsid = nsid;
+		}
+		rta = RTA_NEXT(rta, rtalen);
+	}
+	
+	return 1;
+}
+
+/* Fill nsinfo from the namespace table */
+static int namespace_tracker_fill(struct namespace_tracker *tracker, ino_t nsid,
+                                  struct netns_info *nsinfo)
+{
+	struct ns_cache_entry *ns;
+	
+	memset(nsinfo, 0, sizeof(*nsinfo));
+	nsinfo->nsid = nsid;
+	nsinfo->valid = 1;
+	
+	if (nsid == tracker->self_nsid) {
+		nsinfo->pid = getpid();
+		snprintf(nsinfo->name, sizeof(nsinfo->name), "default");
+		return 0;
+	}
+	
+	ns = id_table_find(&tracker->namespaces, nsid);
+	if (ns && ns->valid) {
+		nsinfo->pid = ns->pid;
+		snprintf(nsinfo->name, sizeof(nsinfo->name), "%s", ns->name);
+		return 0;
+	}
+	
+	snprintf(nsinfo->name, sizeof(nsinfo->name), "ns-%lu", (unsigned long)nsid);
+	return 0;
+}
+
+int namespace_tracker_foreach(struct namespace_tracker *tracker,
+                              namespace_tracker_foreach_fn fn, void *arg)
+{
+	struct netns_info info;
+	char path[512];
+	size_t i;
+	int count = 0;
+	
+	if (!tracker || !fn)
+		return -1;
+	
+	namespace_tracker_refresh(tracker);
+	
+	for (i = 0; i < tracker->namespaces.size; i++) {
+		struct ns_cache_entry *ns = (struct ns_cache_entry *)id_table_slot(&tracker->namespaces, i);
+		
+		if (!ns->slot.used || !ns->valid)
+			continue;
+		
+		/* A bind mount outlives its processes, prefer it */
+		if (ns->named)
+			snprintf(path, sizeof(path), "%s/%s", NETNS_RUN_DIR, ns->name);
+		else if (ns->pid > 0)
+			snprintf(path, sizeof(path), PROC_NET_NS_PATH, ns->pid);
+		else
+			continue;
+		
+		memset(&info, 0, sizeof(info));
+		info.nsid = (ino_t)ns->slot.key;
+		info.pid = ns->pid;
+		info.valid = 1;
+		snprintf(info.name, sizeof(info.name), "%s", ns->name);
+		
+		fn(&info, path, arg);
+		count++;
+	}
+	
+	return count;
+}
+
 int namespace_tracker_resolve_name(struct namespace_tracker *tracker,
                                    ino_t nsid,
                                    char *name,
                                    size_t name_len)
 {
-	int i;
+	struct ns_cache_entry *ns;
 	
 	if (!tracker || !name || name_len == 0)
 		return -1;
 	
-	/* Refresh cache if it's old (> 5 seconds) */
-	if (time(NULL) - tracker->last_scan > 5) {
-		namespace_tracker_update_cache(tracker);
-	}
+	/* Apply directory events, rescan if the reconciliation is due */
+	namespace_tracker_refresh(tracker);
 	
 	/* Search cache */
-	for (i = 0; i < tracker->cache_count; i++) {
-		if (tracker->cache[i].valid && tracker->cache[i].nsid == nsid) {
-			strncpy(name, tracker->cache[i].name, name_len - 1);
-			name[name_len - 1] = '\0';
-			return 0;
-		}
+	ns = id_table_find(&tracker->namespaces, nsid);
+	if (ns && ns->valid) {
+		strncpy(name, ns->name, name_len - 1);
+		name[name_len - 1] = '\0';
+		return 0;
 	}
 	
 	/* Not found, use inode number */
@@ -284,14 +535,19 @@ int namespace_tracker_get_by_ifindex(struct namespace_tracker *tracker,
                                      int ifindex,
                                      struct netns_info *nsinfo)
 {
+	struct if_cache_entry *link;
+	
 	if (!tracker || !nsinfo || ifindex < 0)
 		return -1;
 	
-	/* Try to find namespace by reading /sys/class/net/<ifname>/ifindex */
-	/* This is a simplified approach - in reality, we'd need to track
-	 * interface-to-namespace mappings more carefully */
+	/* Interfaces seen in RTM_NEWLINK carry their namespace */
+	link = id_table_find(&tracker->interfaces, (uint64_t)ifindex);
+	if (link && link->nsid != 0) {
+		namespace_tracker_refresh(tracker);
+		return namespace_tracker_fill(tracker, link->nsid, nsinfo);
+	}
 	
-	/* For now, return current namespace */
+	/* Otherwise, return current namespace */
 	return namespace_tracker_get_current(nsinfo);
 }
 
@@ -323,5 +579,9 @@ void namespace_tracker_destroy(struct namespace_tracker *tracker)
 	if (!tracker)
 		return;
 	
+	if (tracker->inotify_fd >= 0)
+		close(tracker->inotify_fd);
+	id_table_free(&tracker->namespaces);
+	id_table_free(&tracker->interfaces);
 	free(tracker);
 }
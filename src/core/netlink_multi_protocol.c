@@ -1,9 +1,14 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <linux/genetlink.h>
@@ -15,9 +20,33 @@
 
 #include "netlink_multi_protocol.h"
 #include "qca_vendor.h"
+#include "nlmon_clock.h"
 
 #define NLMON_RECV_BUF_SIZE 8192
 
+#ifndef SO_MEMINFO
+#define SO_MEMINFO 55
+#endif
+
+/* Slot of a protocol in stats[] and the epoll data, -1 if unknown */
+static int proto_index(nlmon_protocol_t proto)
+{
+	switch (proto) {
+	case NLMON_PROTO_ROUTE:
+		return 0;
+	case NLMON_PROTO_GENERIC:
+		return 1;
+	case NLMON_PROTO_SOCK_DIAG:
+		return 2;
+	default:
+		return -1;
+	}
+}
+
+static const nlmon_protocol_t index_proto[NLMON_MP_PROTOCOLS] = {
+	NLMON_PROTO_ROUTE, NLMON_PROTO_GENERIC, NLMON_PROTO_SOCK_DIAG,
+};
+
 /* Create and bind a netlink socket for a specific protocol */
 static int create_netlink_socket(int protocol)
 {
@@ -25,7 +54,8 @@ static int create_netlink_socket(int protocol)
 	int sock;
 	int buf_size = 32768;
 	
-	sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
+	/* Non-blocking so edge-triggered dispatch can drain it */
+	sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, protocol);
 	if (sock < 0) {
 		perror("socket");
 		return -1;
@@ -76,9 +106,37 @@ struct nlmon_multi_protocol_ctx *nlmon_multi_protocol_init(void)
 	ctx->enable_generic = 0;
 	ctx->enable_sock_diag = 0;
 	
+	ctx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (ctx->epoll_fd < 0) {
+		perror("epoll_create1");
+		free(ctx);
+		return NULL;
+	}
+	
+	ctx->budget = NLMON_MP_DEFAULT_BUDGET;
+	for (int i = 0; i < NLMON_MP_PROTOCOLS; i++)
+		ctx->stats[i].weight = 1;
+	
 	return ctx;
 }
 
+/* Add a protocol socket to the epoll set, closing it on failure */
+static int watch_socket(struct nlmon_multi_protocol_ctx *ctx, nlmon_protocol_t proto, int sock)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLET,
+		.data.u32 = (uint32_t)proto_index(proto),
+	};
+	
+	if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+		perror("epoll_ctl");
+		close(sock);
+		return -1;
+	}
+	
+	return sock;
+}
+
 int nlmon_multi_protocol_enable(struct nlmon_multi_protocol_ctx *ctx, nlmon_protocol_t proto)
 {
 	int sock;
@@ -92,7 +150,7 @@ int nlmon_multi_protocol_enable(struct nlmon_multi_protocol_ctx *ctx, nlmon_prot
 			return 0;  /* Already enabled */
 		
 		sock = create_netlink_socket(NETLINK_ROUTE);
-		if (sock < 0)
+		if (sock < 0 || watch_socket(ctx, proto, sock) < 0)
 			return -1;
 		
 		ctx->route_sock = sock;
@@ -104,7 +162,7 @@ int nlmon_multi_protocol_enable(struct nlmon_multi_protocol_ctx *ctx, nlmon_prot
 			return 0;  /* Already enabled */
 		
 		sock = create_netlink_socket(NETLINK_GENERIC);
-		if (sock < 0)
+		if (sock < 0 || watch_socket(ctx, proto, sock) < 0)
 			return -1;
 		
 		ctx->generic_sock = sock;
@@ -116,7 +174,7 @@ int nlmon_multi_protocol_enable(struct nlmon_multi_protocol_ctx *ctx, nlmon_prot
 			return 0;  /* Already enabled */
 		
 		sock = create_netlink_socket(NETLINK_SOCK_DIAG);
-		if (sock < 0)
+		if (sock < 0 || watch_socket(ctx, proto, sock) < 0)
 			return -1;
 		
 		ctx->sock_diag_sock = sock;
@@ -138,6 +196,7 @@ int nlmon_multi_protocol_disable(struct nlmon_multi_protocol_ctx *ctx, nlmon_pro
 	switch (proto) {
 	case NLMON_PROTO_ROUTE:
 		if (ctx->route_sock >= 0) {
+			epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, ctx->route_sock, NULL);
 			close(ctx->route_sock);
 			ctx->route_sock = -1;
 		}
@@ -146,6 +205,7 @@ int nlmon_multi_protocol_disable(struct nlmon_multi_protocol_ctx *ctx, nlmon_pro
 		
 	case NLMON_PROTO_GENERIC:
 		if (ctx->generic_sock >= 0) {
+			epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, ctx->generic_sock, NULL);
 			close(ctx->generic_sock);
 			ctx->generic_sock = -1;
 		}
@@ -154,6 +214,7 @@ int nlmon_multi_protocol_disable(struct nlmon_multi_protocol_ctx *ctx, nlmon_pro
 		
 	case NLMON_PROTO_SOCK_DIAG:
 		if (ctx->sock_diag_sock >= 0) {
+			epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, ctx->sock_diag_sock, NULL);
 			close(ctx->sock_diag_sock);
 			ctx->sock_diag_sock = -1;
 		}
@@ -237,9 +298,14 @@ int nlmon_parse_generic_msg(struct nlmsghdr *nlh, struct nlmon_generic_msg *msg)
 	
 	/* Check if this is a QCA vendor command */
 	if (is_vendor_cmd && vendor_id == OUI_QCA) {
-		/* TODO: Implement qca_vendor_subcmd_to_string() for vendor subcmd decoding */
-		snprintf(msg->family_name, sizeof(msg->family_name), 
-		         "nl80211/QCA:0x%x", vendor_subcmd);
+		const char *subcmd_name = qca_vendor_subcmd_to_string(vendor_subcmd);
+		
+		if (subcmd_name)
+			snprintf(msg->family_name, sizeof(msg->family_name),
+			         "nl80211/QCA:%s", subcmd_name);
+		else
+			snprintf(msg->family_name, sizeof(msg->family_name),
+			         "nl80211/QCA:0x%x", vendor_subcmd);
 		msg->cmd = vendor_subcmd;  /* Override with vendor subcmd for better display */
 	} else if (is_vendor_cmd) {
 		snprintf(msg->family_name, sizeof(msg->family_name), 
@@ -350,29 +416,12 @@ static void process_sock_diag_msg(struct nlmon_multi_protocol_ctx *ctx, struct n
 	}
 }
 
-int nlmon_multi_protocol_process(struct nlmon_multi_protocol_ctx *ctx, nlmon_protocol_t proto)
+/* Process the messages of one datagram, returns how many were processed */
+static int process_datagram(struct nlmon_multi_protocol_ctx *ctx, nlmon_protocol_t proto,
+                            char *buf, ssize_t len)
 {
-	char buf[NLMON_RECV_BUF_SIZE];
 	struct nlmsghdr *nlh;
-	int sock;
-	ssize_t len;
-	
-	if (!ctx)
-		return -1;
-	
-	sock = nlmon_multi_protocol_get_fd(ctx, proto);
-	if (sock < 0)
-		return -1;
-	
-	len = recv(sock, buf, sizeof(buf), MSG_DONTWAIT);
-	if (len < 0) {
-		if (errno == EAGAIN || errno == EWOULDBLOCK)
-			return 0;  /* No data available */
-		return -1;
-	}
-	
-	if (len == 0)
-		return 0;
+	int count = 0;
 	
 	/* Process all messages in the buffer */
 	for (nlh = (struct nlmsghdr *)buf;
@@ -404,8 +453,209 @@ int nlmon_multi_protocol_process(struct nlmon_multi_protocol_ctx *ctx, nlmon_pro
 			process_sock_diag_msg(ctx, nlh);
 			break;
 		}
+		count++;
+	}
+	
+	return count;
+}
+
+/*
+ * Receive and process up to @max datagrams of a protocol in one recvmmsg()
+ *
+ * Returns the number of datagrams read, or -1 on a receive error. Sets
+ * *drained when the socket ran dry or cannot be read any more.
+ */
+static int drain_batch(struct nlmon_multi_protocol_ctx *ctx, nlmon_protocol_t proto,
+                       unsigned int max, int *drained)
+{
+	struct nlmon_multi_protocol_stats *stats = &ctx->stats[proto_index(proto)];
+	struct mmsghdr msgs[NLMON_MP_BATCH];
+	struct iovec iovs[NLMON_MP_BATCH];
+	unsigned int i;
+	int sock, n;
+	
+	sock = nlmon_multi_protocol_get_fd(ctx, proto);
+	if (sock < 0) {
+		*drained = 1;
+		return -1;
+	}
+	
+	if (!ctx->recv_bufs) {
+		ctx->recv_bufs = malloc(NLMON_MP_BATCH * NLMON_RECV_BUF_SIZE);
+		if (!ctx->recv_bufs) {
+			*drained = 1;
+			return -1;
+		}
 	}
 	
+	if (max > NLMON_MP_BATCH)
+		max = NLMON_MP_BATCH;
+	
+	memset(msgs, 0, max * sizeof(*msgs));
+	for (i = 0; i < max; i++) {
+		iovs[i].iov_base = ctx->recv_bufs + i * NLMON_RECV_BUF_SIZE;
+		iovs[i].iov_len = NLMON_RECV_BUF_SIZE;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	
+	n = recvmmsg(sock, msgs, max, MSG_DONTWAIT, NULL);
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			*drained = 1;
+			return 0;
+		}
+		
+		stats->errors++;
+		
+		/* Overrun: messages were lost but the queue is still readable */
+		if (errno == ENOBUFS || errno == EINTR)
+			return 0;
+		
+		*drained = 1;
+		return -1;
+	}
+	
+	/* A short batch stopped on an empty queue, new data brings a new edge */
+	if ((unsigned int)n < max)
+		*drained = 1;
+	
+	stats->datagrams += n;
+	for (i = 0; i < (unsigned int)n; i++)
+		stats->messages += process_datagram(ctx, proto, iovs[i].iov_base, msgs[i].msg_len);
+	
+	return n;
+}
+
+/* Bytes waiting in a socket's receive queue */
+static uint32_t socket_backlog(int sock)
+{
+	uint32_t meminfo[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(meminfo);
+	
+	if (sock < 0 || getsockopt(sock, SOL_SOCKET, SO_MEMINFO, meminfo, &len) < 0 ||
+	    len <= SK_MEMINFO_RMEM_ALLOC * sizeof(uint32_t))
+		return 0;
+	
+	return meminfo[SK_MEMINFO_RMEM_ALLOC];
+}
+
+int nlmon_multi_protocol_process(struct nlmon_multi_protocol_ctx *ctx, nlmon_protocol_t proto)
+{
+	int drained = 0;
+	
+	if (!ctx || proto_index(proto) < 0)
+		return -1;
+	
+	return drain_batch(ctx, proto, NLMON_MP_BATCH, &drained) < 0 ? -1 : 0;
+}
+
+int nlmon_multi_protocol_get_epoll_fd(struct nlmon_multi_protocol_ctx *ctx)
+{
+	return ctx ? ctx->epoll_fd : -1;
+}
+
+int nlmon_multi_protocol_dispatch(struct nlmon_multi_protocol_ctx *ctx)
+{
+	struct epoll_event events[NLMON_MP_PROTOCOLS];
+	unsigned int quota[NLMON_MP_PROTOCOLS] = { 0 };
+	uint64_t before = 0, after = 0;
+	unsigned int ready = 0;
+	int i, n;
+	
+	if (!ctx)
+		return -1;
+	
+	n = epoll_wait(ctx->epoll_fd, events, NLMON_MP_PROTOCOLS, 0);
+	if (n < 0)
+		return errno == EINTR ? 0 : -1;
+	
+	for (i = 0; i < n; i++) {
+		uint32_t idx = events[i].data.u32;
+		
+		if (idx >= NLMON_MP_PROTOCOLS)
+			continue;
+		ready |= 1u << idx;
+		quota[idx] = ctx->stats[idx].weight * ctx->budget;
+		ctx->stats[idx].drains++;
+	}
+	
+	for (i = 0; i < NLMON_MP_PROTOCOLS; i++)
+		before += ctx->stats[i].messages;
+	
+	/* One batch per protocol and round, so a storm on one cannot starve the others */
+	while (ready) {
+		for (i = 0; i < NLMON_MP_PROTOCOLS; i++) {
+			struct nlmon_multi_protocol_stats *stats = &ctx->stats[i];
+			struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.u32 = i };
+			uint64_t start;
+			int drained = 0;
+			int got, sock;
+			
+			if (!(ready & (1u << i)))
+				continue;
+			
+			start = nlmon_clock_precise_ns();
+			got = drain_batch(ctx, index_proto[i], quota[i], &drained);
+			stats->drain_ns += nlmon_clock_precise_ns() - start;
+			
+			/* Errors use up the budget too, a failing socket cannot spin */
+			quota[i] -= got > 0 ? (unsigned int)got : 1;
+			if (drained) {
+				ready &= ~(1u << i);
+				continue;
+			}
+			if (quota[i] > 0)
+				continue;
+			
+			/* Out of budget with data left: re-arm so the next wakeup comes back to it */
+			ready &= ~(1u << i);
+			sock = nlmon_multi_protocol_get_fd(ctx, index_proto[i]);
+			stats->backlog = socket_backlog(sock);
+			if (stats->backlog == 0)
+				continue;
+			stats->budget_exhausted++;
+			epoll_ctl(ctx->epoll_fd, EPOLL_CTL_MOD, sock, &ev);
+		}
+	}
+	
+	for (i = 0; i < NLMON_MP_PROTOCOLS; i++)
+		after += ctx->stats[i].messages;
+	
+	return (int)(after - before);
+}
+
+int nlmon_multi_protocol_set_weight(struct nlmon_multi_protocol_ctx *ctx, nlmon_protocol_t proto,
+                                    unsigned int weight)
+{
+	int idx = proto_index(proto);
+	
+	if (!ctx || idx < 0 || weight == 0)
+		return -1;
+	
+	ctx->stats[idx].weight = weight;
+	return 0;
+}
+
+int nlmon_multi_protocol_set_budget(struct nlmon_multi_protocol_ctx *ctx, unsigned int budget)
+{
+	if (!ctx || budget == 0)
+		return -1;
+	
+	ctx->budget = budget;
+	return 0;
+}
+
+int nlmon_multi_protocol_get_stats(struct nlmon_multi_protocol_ctx *ctx, nlmon_protocol_t proto,
+                                   struct nlmon_multi_protocol_stats *stats)
+{
+	int idx = proto_index(proto);
+	
+	if (!ctx || idx < 0 || !stats)
+		return -1;
+	
+	ctx->stats[idx].backlog = socket_backlog(nlmon_multi_protocol_get_fd(ctx, proto));
+	*stats = ctx->stats[idx];
 	return 0;
 }
 
@@ -420,6 +670,9 @@ void nlmon_multi_protocol_destroy(struct nlmon_multi_protocol_ctx *ctx)
 		close(ctx->generic_sock);
 	if (ctx->sock_diag_sock >= 0)
 		close(ctx->sock_diag_sock);
+	if (ctx->epoll_fd >= 0)
+		close(ctx->epoll_fd);
 	
+	free(ctx->recv_bufs);
 	free(ctx);
 }
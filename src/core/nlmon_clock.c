@@ -0,0 +1,151 @@
+/* nlmon_clock.c - Time service shared by all subsystems */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "nlmon_clock.h"
+
+/* Shortest calibration of the cycle counter */
+#define CALIBRATE_NS 5000000ULL
+
+struct nlmon_clock_page nlmon_clock_page;
+
+static pthread_mutex_t ticker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ticker_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t ticker;
+static bool ticker_running;
+static bool ticker_stop;
+static unsigned int ticker_interval_ms;
+
+static pthread_once_t calibrate_once = PTHREAD_ONCE_INIT;
+static double ns_per_cycle = 1.0;
+
+static void calibrate(void)
+{
+#if defined(__aarch64__)
+	uint64_t freq;
+	
+	/* The counter states its own frequency */
+	__asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(freq));
+	ns_per_cycle = freq ? 1e9 / (double)freq : 1.0;
+#elif defined(__x86_64__) || defined(__i386__)
+	uint64_t start_ns = nlmon_clock_precise_ns(), start = nlmon_clock_cycles();
+	uint64_t ns, cycles;
+	
+	do {
+		ns = nlmon_clock_precise_ns();
+		cycles = nlmon_clock_cycles();
+	} while (ns - start_ns < CALIBRATE_NS);
+	ns_per_cycle = cycles > start ? (double)(ns - start_ns) / (double)(cycles - start) : 1.0;
+#else
+	ns_per_cycle = 1.0;
+#endif
+}
+
+double nlmon_clock_ns_per_cycle(void)
+{
+	pthread_once(&calibrate_once, calibrate);
+	return ns_per_cycle;
+}
+
+void nlmon_clock_update(void)
+{
+	atomic_store_explicit(&nlmon_clock_page.monotonic_ns, nlmon_clock_read(CLOCK_MONOTONIC),
+	                      memory_order_relaxed);
+	atomic_store_explicit(&nlmon_clock_page.realtime_ns, nlmon_clock_read(CLOCK_REALTIME),
+	                      memory_order_relaxed);
+	atomic_fetch_add_explicit(&nlmon_clock_page.ticks, 1, memory_order_relaxed);
+}
+
+static void *ticker_thread(void *arg)
+{
+	struct timespec deadline;
+	
+	(void)arg;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	
+	pthread_mutex_lock(&ticker_lock);
+	while (!ticker_stop) {
+		nlmon_clock_update();
+		
+		deadline.tv_nsec += (long)ticker_interval_ms * 1000000L;
+		while (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_nsec -= 1000000000L;
+			deadline.tv_sec++;
+		}
+		while (!ticker_stop &&
+		       pthread_cond_timedwait(&ticker_cond, &ticker_lock, &deadline) != ETIMEDOUT)
+			;
+	}
+	pthread_mutex_unlock(&ticker_lock);
+	
+	return NULL;
+}
+
+int nlmon_clock_start(unsigned int interval_ms)
+{
+	pthread_condattr_t attr;
+	int ret = 0;
+	
+	pthread_mutex_lock(&ticker_lock);
+	
+	if (ticker_running)
+		goto out;
+	
+	/* Deadlines are on CLOCK_MONOTONIC, wall clock steps must not stall the ticker */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_destroy(&ticker_cond);
+	pthread_cond_init(&ticker_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	
+	ticker_interval_ms = interval_ms ? interval_ms : NLMON_CLOCK_DEFAULT_INTERVAL_MS;
+	ticker_stop = false;
+	nlmon_clock_update();
+	
+	if (pthread_create(&ticker, NULL, ticker_thread, NULL) != 0) {
+		atomic_store(&nlmon_clock_page.realtime_ns, 0);
+		atomic_store(&nlmon_clock_page.monotonic_ns, 0);
+		ret = -1;
+		goto out;
+	}
+	ticker_running = true;
+	
+out:
+	pthread_mutex_unlock(&ticker_lock);
+	return ret;
+}
+
+void nlmon_clock_stop(void)
+{
+	pthread_mutex_lock(&ticker_lock);
+	if (!ticker_running) {
+		pthread_mutex_unlock(&ticker_lock);
+		return;
+	}
+	ticker_stop = true;
+	pthread_cond_signal(&ticker_cond);
+	pthread_mutex_unlock(&ticker_lock);
+	
+	pthread_join(ticker, NULL);
+	
+	pthread_mutex_lock(&ticker_lock);
+	ticker_running = false;
+	atomic_store(&nlmon_clock_page.realtime_ns, 0);
+	atomic_store(&nlmon_clock_page.monotonic_ns, 0);
+	pthread_mutex_unlock(&ticker_lock);
+}
+
+bool nlmon_clock_running(void)
+{
+	bool running;
+	
+	pthread_mutex_lock(&ticker_lock);
+	running = ticker_running;
+	pthread_mutex_unlock(&ticker_lock);
+	
+	return running;
+}
@@ -6,12 +6,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <arpa/inet.h>
 #include <net/if.h>
+#include <linux/filter.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <linux/genetlink.h>
+#include <linux/netfilter/nfnetlink.h>
 
 #include <netlink/netlink.h>
 #include <netlink/socket.h>
@@ -26,9 +36,47 @@
 #include "nlmon_config.h"
 #include "nlmon_nl_route.h"
 #include "nlmon_nl_genl.h"
+#include "nlmon_nl_family.h"
 #include "nlmon_nl_diag.h"
 #include "nlmon_nl_netfilter.h"
 #include "nlmon_nl_error.h"
+#include "nlmon_nl_event.h"
+#include "nlmon_nl_limits.h"
+#include "nlmon_nl_delta.h"
+#include "nlmon_nl_msgpool.h"
+#include "event_processor.h"
+#include "nlmon_probes.h"
+#include "io_recv.h"
+#include "nlmon_clock.h"
+
+/**
+ * Per-protocol receive thread state
+ */
+struct nlmon_nl_rx_thread {
+	struct nlmon_nl_manager *mgr;
+	pthread_t thread;
+	int started;
+	int stop_fd;                     /* eventfd used to wake the thread for shutdown */
+	struct io_recv *recv;            /* Receives every socket instead of polling one */
+	atomic_int stopping;             /* Stop request to a thread blocked in io_recv_run() */
+	int lane;                        /* Event processor producer lane */
+	const char *name;
+	int (*get_fd)(struct nlmon_nl_manager *mgr);
+	int (*process)(struct nlmon_nl_manager *mgr);
+};
+
+/* Producer lane of the calling receive thread, -1 outside receive threads */
+static __thread int nlmon_nl_rx_lane = -1;
+
+/* Messages and bytes seen by the current nl_recvmsgs() call */
+static __thread size_t nlmon_nl_batch_msgs;
+static __thread size_t nlmon_nl_batch_bytes;
+
+/* Receipt of the message being handled on this thread, for event tracing */
+static __thread uint64_t nlmon_nl_recv_ns;
+
+/* Wall clock time of that message, 0 outside a receive */
+static __thread uint64_t nlmon_nl_recv_stamp;
 
 /* Forward declarations of message handlers */
 extern int nlmon_route_msg_handler(struct nl_msg *msg, void *arg);
@@ -36,6 +84,15 @@ extern int nlmon_genl_msg_handler(struct nl_msg *msg, void *arg);
 extern int nlmon_diag_msg_handler(struct nl_msg *msg, void *arg);
 extern int nlmon_nf_msg_handler(struct nl_msg *msg, void *arg);
 
+static int nlmon_nl_attach_filter(struct nlmon_nl_manager *mgr, struct nl_sock *sk,
+                                  int protocol);
+static int nlmon_nl_filter_slot(int protocol);
+static struct nl_sock *nlmon_nl_protocol_sock(struct nlmon_nl_manager *mgr, int protocol);
+static struct nl_cb *nlmon_nl_protocol_cb(struct nlmon_nl_manager *mgr, int protocol);
+static void nlmon_nl_recv_rebind(struct nlmon_nl_manager *mgr, int protocol);
+static int nlmon_nl_join_ct_groups(struct nlmon_nl_manager *mgr);
+static int nlmon_nl_connect(struct nlmon_nl_manager *mgr, struct nl_sock *sk, int protocol);
+
 /**
  * No-op sequence check callback
  * Used to disable sequence number checking for asynchronous netlink events
@@ -47,6 +104,256 @@ static int noop_seq_check(struct nl_msg *msg, void *arg)
 	return NL_OK;
 }
 
+/**
+ * Message-in callback counting received messages for limits accounting
+ */
+static int nlmon_nl_count_msg(struct nl_msg *msg, void *arg)
+{
+	(void)arg;
+	
+	NLMON_PROBE2(nl_recv, nlmsg_hdr(msg)->nlmsg_type, nlmsg_hdr(msg)->nlmsg_len);
+	nlmon_nl_recv_ns = nlmon_trace_enabled() ? nlmon_trace_now() : 0;
+	nlmon_nl_recv_stamp = nlmon_clock_realtime_ns();
+	nlmon_nl_batch_msgs++;
+	nlmon_nl_batch_bytes += nlmsg_hdr(msg)->nlmsg_len;
+	return NL_OK;
+}
+
+/**
+ * Receive messages, feeding rates and buffer occupancy to the limits tracker
+ */
+static int nlmon_nl_recvmsgs(struct nlmon_nl_manager *mgr, struct nl_sock *sk,
+                             struct nl_cb *cb)
+{
+	struct timespec start, end;
+	int ret, saved_errno;
+	
+	if (!mgr->limits) {
+		ret = nl_recvmsgs(sk, cb);
+		nlmon_nl_recv_stamp = 0;
+		return ret;
+	}
+	
+	nlmon_nl_batch_msgs = 0;
+	nlmon_nl_batch_bytes = 0;
+	
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = nl_recvmsgs(sk, cb);
+	saved_errno = errno;
+	nlmon_nl_recv_stamp = 0;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	
+	nlmon_nl_limits_record_batch(mgr->limits, nl_socket_get_fd(sk),
+	                             nlmon_nl_batch_msgs, nlmon_nl_batch_bytes,
+	                             (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL +
+	                             (uint64_t)end.tv_nsec - (uint64_t)start.tv_nsec);
+	
+	/* Overruns are handled by nlmon_nl_handle_overrun() */
+	if (!(ret == -NLE_NOMEM && saved_errno == ENOBUFS))
+		nlmon_nl_limits_autotune(mgr->limits, nl_socket_get_fd(sk), false);
+	
+	/* Callers inspect errno to classify failures */
+	errno = saved_errno;
+	return ret;
+}
+
+/**
+ * Invoke one callback of @cb, NL_OK when it is not set
+ */
+static int nlmon_nl_cb_call(struct nl_cb *cb, enum nl_cb_type type, struct nl_msg *msg)
+{
+	if (!cb->cb_set[type])
+		return NL_OK;
+	
+	return cb->cb_set[type](msg, cb->cb_args[type]);
+}
+
+/**
+ * Handle an NLMSG_ERROR message the way nl_recvmsgs() does
+ */
+static int nlmon_nl_parse_error(struct nl_cb *cb, struct nl_msg *msg, struct sockaddr_nl *nla)
+{
+	struct nlmsghdr *hdr = nlmsg_hdr(msg);
+	struct nlmsgerr *e = nlmsg_data(hdr);
+	int err;
+	
+	if (hdr->nlmsg_len < (unsigned int)nlmsg_msg_size(sizeof(*e))) {
+		if (!cb->cb_set[NL_CB_INVALID])
+			return -NLE_MSG_TRUNC;
+		return nlmon_nl_cb_call(cb, NL_CB_INVALID, msg);
+	}
+	
+	if (!e->error)
+		return nlmon_nl_cb_call(cb, NL_CB_ACK, msg);
+	
+	if (!cb->cb_err)
+		return -nl_syserr2nlerr(e->error);
+	
+	err = cb->cb_err(nla, e, cb->cb_err_arg);
+	if (err == NL_STOP)
+		return -nl_syserr2nlerr(e->error);
+	
+	return err;
+}
+
+/**
+ * Run a datagram received elsewhere through a socket's callbacks
+ * 
+ * Does for a notification socket what nl_recvmsgs() does after its
+ * recvmsg(), but leaves the messages where they are: each nl_msg given
+ * to the callbacks points into @data, which the caller reuses once this
+ * returns. Sequence numbers are left to NL_CB_SEQ_CHECK, the manager's
+ * sockets receive notifications and do not track them.
+ */
+static int nlmon_nl_parse_datagram(struct nl_cb *cb, int protocol, void *data, size_t len,
+                                   const struct sockaddr_nl *src)
+{
+	struct nlmsghdr *hdr = data;
+	int remaining = (int)len;
+	struct nl_msg msg;
+	int err;
+	
+	memset(&msg, 0, sizeof(msg));
+	msg.nm_protocol = protocol;
+	msg.nm_refcnt = 1;
+	msg.nm_src.nl_family = AF_NETLINK;
+	if (src)
+		msg.nm_src = *src;
+	
+	for (; nlmsg_ok(hdr, remaining); hdr = nlmsg_next(hdr, &remaining)) {
+		msg.nm_nlh = hdr;
+		msg.nm_size = hdr->nlmsg_len;
+		
+		err = nlmon_nl_cb_call(cb, NL_CB_MSG_IN, &msg);
+		if (err == NL_OK)
+			err = nlmon_nl_cb_call(cb, NL_CB_SEQ_CHECK, &msg);
+		
+		if (err == NL_OK) {
+			switch (hdr->nlmsg_type) {
+			case NLMSG_DONE:
+				err = nlmon_nl_cb_call(cb, NL_CB_FINISH, &msg);
+				break;
+			case NLMSG_NOOP:
+				err = cb->cb_set[NL_CB_SKIPPED] ?
+				      nlmon_nl_cb_call(cb, NL_CB_SKIPPED, &msg) : NL_SKIP;
+				break;
+			case NLMSG_OVERRUN:
+				if (!cb->cb_set[NL_CB_OVERRUN])
+					return -NLE_MSG_OVERFLOW;
+				err = nlmon_nl_cb_call(cb, NL_CB_OVERRUN, &msg);
+				break;
+			case NLMSG_ERROR:
+				err = nlmon_nl_parse_error(cb, &msg, &msg.nm_src);
+				break;
+			default:
+				err = nlmon_nl_cb_call(cb, NL_CB_VALID, &msg);
+				break;
+			}
+		}
+		
+		if (err == NL_STOP)
+			return 0;
+		if (err != NL_OK && err != NL_SKIP)
+			return err;
+	}
+	
+	/* A partial message is left when the datagram did not fit the buffer */
+	return remaining > 0 ? -NLE_MSG_TRUNC : 0;
+}
+
+/**
+ * io_recv handler of a protocol socket
+ */
+static void nlmon_nl_recv_datagram(void *ctx, int source, const struct io_recv_msg *msg,
+                                   int error)
+{
+	struct nlmon_nl_recv_slot *slot = ctx;
+	struct nlmon_nl_manager *mgr = slot->mgr;
+	struct nl_sock *sk = nlmon_nl_protocol_sock(mgr, slot->protocol);
+	struct nl_cb *cb = nlmon_nl_protocol_cb(mgr, slot->protocol);
+	struct timespec start, end;
+	int ret;
+	
+	(void)source;
+	nlmon_nl_rx_lane = slot->lane;
+	
+	/* Receive buffer overrun - notifications were lost, recover state */
+	if (error == -ENOBUFS) {
+		nlmon_nl_handle_overrun(mgr, slot->protocol);
+		return;
+	}
+	
+	if (error) {
+		nlmon_nl_log_error("Error receiving netlink messages", error);
+		
+		/* The receive stays idle until a new socket replaces it */
+		if (error == -EBADF || error == -ENOTCONN) {
+			ret = nlmon_nl_reconnect(mgr, slot->protocol);
+			if (ret < 0)
+				nlmon_nl_log_error("Reconnection failed", ret);
+		}
+		return;
+	}
+	
+	if (!sk || !cb)
+		return;
+	
+	if (mgr->limits) {
+		nlmon_nl_batch_msgs = 0;
+		nlmon_nl_batch_bytes = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+	}
+	
+	ret = nlmon_nl_parse_datagram(cb, slot->protocol, msg->data, msg->len,
+	                              msg->namelen >= sizeof(struct sockaddr_nl) ?
+	                              msg->name : NULL);
+	nlmon_nl_recv_stamp = 0;
+	
+	if (mgr->limits) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		nlmon_nl_limits_record_batch(mgr->limits, nl_socket_get_fd(sk),
+		                             nlmon_nl_batch_msgs, nlmon_nl_batch_bytes,
+		                             (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL +
+		                             (uint64_t)end.tv_nsec - (uint64_t)start.tv_nsec);
+		nlmon_nl_limits_autotune(mgr->limits, nl_socket_get_fd(sk), false);
+	}
+	
+	if (ret < 0)
+		nlmon_nl_log_error("Error processing received netlink messages", ret);
+}
+
+/* libnl buffer pool callbacks over an nlmon_nl_msgpool */
+static void *nlmon_nl_pool_alloc(void *priv, size_t size)
+{
+	return nlmon_nl_msgpool_alloc(priv, size);
+}
+
+static void *nlmon_nl_pool_realloc(void *priv, void *buf, size_t old_size, size_t new_size)
+{
+	return nlmon_nl_msgpool_realloc(priv, buf, old_size, new_size);
+}
+
+static void nlmon_nl_pool_free(void *priv, void *buf)
+{
+	nlmon_nl_msgpool_free(priv, buf);
+}
+
+/**
+ * Point a protocol socket's receive buffers at the manager's pool
+ */
+static void nlmon_nl_apply_msgpool(struct nlmon_nl_manager *mgr, struct nl_sock *sk)
+{
+	struct nl_buf_pool pool = {
+		.alloc = nlmon_nl_pool_alloc,
+		.realloc = nlmon_nl_pool_realloc,
+		.free = nlmon_nl_pool_free,
+		.priv = mgr->rx_pool,
+	};
+	
+	if (sk)
+		nl_socket_set_buf_pool(sk, mgr->rx_pool ? &pool : NULL);
+}
+
 /**
  * Initialize netlink manager
  */
@@ -91,6 +398,41 @@ struct nlmon_nl_manager *nlmon_nl_manager_init(void)
 	mgr->addr_cache = NULL;
 	mgr->route_cache = NULL;
 	
+	/* Messages are processed by the caller's thread by default */
+	mgr->rx_threads = NULL;
+	mgr->rx_thread_count = 0;
+	mgr->rx_processor = NULL;
+	mgr->rx_handler_id = -1;
+	
+	/* No io_recv attached */
+	mgr->rx_recv = NULL;
+	for (int i = 0; i < 4; i++)
+		mgr->rx_recv_slots[i].source = -1;
+	
+	/* Overrun recovery disabled until nlmon_nl_enable_resync() */
+	mgr->state = NULL;
+	mgr->limits = NULL;
+	
+	/* No kernel prefilters until nlmon_nl_set_filter() */
+	memset(mgr->filters, 0, sizeof(mgr->filters));
+	memset(mgr->filter_lens, 0, sizeof(mgr->filter_lens));
+	
+	/* Every conntrack event until nlmon_nl_set_ct_filter() */
+	mgr->ct_prog = NULL;
+	mgr->ct_prog_len = 0;
+	mgr->ct_events = NLMON_CT_EVENT_ALL;
+	
+	/* Sockets open in the caller's namespace */
+	mgr->netns_fd = -1;
+	
+	/* New sockets until nlmon_nl_adopt_socket() */
+	for (int i = 0; i < 4; i++)
+		mgr->adopt_fds[i] = -1;
+	
+	/* Pooled receive buffers, the heap if the pool cannot be had */
+	mgr->rx_pool = nlmon_nl_msgpool_create(NLMON_NL_RX_POOL_BUFFERS, NLMON_NL_RX_BUFFER_SIZE);
+	mgr->rx_pool_owned = mgr->rx_pool != NULL;
+	
 	return mgr;
 }
 
@@ -102,6 +444,13 @@ void nlmon_nl_manager_destroy(struct nlmon_nl_manager *mgr)
 	if (!mgr)
 		return;
 	
+	/* Receive threads use the sockets below */
+	nlmon_nl_stop_rx_threads(mgr);
+	nlmon_nl_detach_io_recv(mgr);
+	
+	/* Free resync state */
+	nlmon_nl_disable_resync(mgr);
+	
 	/* Free caches */
 	if (mgr->link_cache)
 		nl_cache_free(mgr->link_cache);
@@ -138,6 +487,16 @@ void nlmon_nl_manager_destroy(struct nlmon_nl_manager *mgr)
 		nl_socket_free(mgr->nf_sock);
 	}
 	
+	for (int i = 0; i < 4; i++) {
+		free(mgr->filters[i]);
+		if (mgr->adopt_fds[i] >= 0)
+			close(mgr->adopt_fds[i]);
+	}
+	free(mgr->ct_prog);
+	
+	if (mgr->rx_pool_owned)
+		nlmon_nl_msgpool_destroy(mgr->rx_pool);
+	
 	/* Free manager structure */
 	free(mgr);
 }
@@ -163,11 +522,13 @@ int nlmon_nl_enable_route(struct nlmon_nl_manager *mgr)
 		return -ENOMEM;
 	}
 	
+	nlmon_nl_apply_msgpool(mgr, mgr->route_sock);
+	
 	/* Disable sequence number checking for asynchronous events */
 	nl_socket_disable_seq_check(mgr->route_sock);
 	
 	/* Connect to NETLINK_ROUTE */
-	ret = nl_connect(mgr->route_sock, NETLINK_ROUTE);
+	ret = nlmon_nl_connect(mgr, mgr->route_sock, NETLINK_ROUTE);
 	if (ret < 0) {
 		nlmon_nl_log_error("Failed to connect to NETLINK_ROUTE", ret);
 		nl_socket_free(mgr->route_sock);
@@ -175,6 +536,11 @@ int nlmon_nl_enable_route(struct nlmon_nl_manager *mgr)
 		return ret;
 	}
 	
+	/* Drop unwanted messages before they are queued (non-fatal) */
+	ret = nlmon_nl_attach_filter(mgr, mgr->route_sock, NETLINK_ROUTE);
+	if (ret < 0)
+		nlmon_nl_log_error("Failed to attach NETLINK_ROUTE prefilter (non-fatal)", ret);
+	
 	/* Increase buffer sizes for high-traffic scenarios */
 	ret = nl_socket_set_buffer_size(mgr->route_sock, 32768, 32768);
 	if (ret < 0) {
@@ -226,6 +592,7 @@ int nlmon_nl_enable_route(struct nlmon_nl_manager *mgr)
 	
 	/* Set up route message callback handler */
 	nl_cb_set(mgr->route_cb, NL_CB_VALID, NL_CB_CUSTOM, nlmon_route_msg_handler, mgr);
+	nl_cb_set(mgr->route_cb, NL_CB_MSG_IN, NL_CB_CUSTOM, nlmon_nl_count_msg, NULL);
 	
 	mgr->enable_route = 1;
 	
@@ -253,11 +620,13 @@ int nlmon_nl_enable_generic(struct nlmon_nl_manager *mgr)
 		return -ENOMEM;
 	}
 	
+	nlmon_nl_apply_msgpool(mgr, mgr->genl_sock);
+	
 	/* Disable sequence number checking */
 	nl_socket_disable_seq_check(mgr->genl_sock);
 	
 	/* Connect to NETLINK_GENERIC */
-	ret = genl_connect(mgr->genl_sock);
+	ret = nlmon_nl_connect(mgr, mgr->genl_sock, NETLINK_GENERIC);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to connect to NETLINK_GENERIC: %s\n",
 		        nl_geterror(ret));
@@ -266,6 +635,29 @@ int nlmon_nl_enable_generic(struct nlmon_nl_manager *mgr)
 		return ret;
 	}
 	
+	/* Drop unwanted messages before they are queued (non-fatal) */
+	ret = nlmon_nl_attach_filter(mgr, mgr->genl_sock, NETLINK_GENERIC);
+	if (ret < 0) {
+		fprintf(stderr, "Warning: Failed to attach NETLINK_GENERIC prefilter: %s\n",
+		        strerror(-ret));
+	}
+	
+	/* Cache the families while the socket still blocks, then follow
+	 * the controller for families registered later (non-fatal). Family
+	 * IDs are global but other namespaces only list the netns aware
+	 * families, so only a dump of our own namespace fills the cache. */
+	ret = mgr->netns_fd < 0 ? nlmon_genl_family_cache_fill(mgr->genl_sock) : 0;
+	if (ret < 0) {
+		fprintf(stderr, "Warning: Failed to cache generic netlink families: %s\n",
+		        nl_geterror(ret));
+	} else {
+		mgr->nl80211_id = nlmon_genl_family_find("nl80211", NULL);
+		ret = nlmon_genl_family_cache_subscribe(mgr->genl_sock);
+		if (ret < 0)
+			fprintf(stderr, "Warning: Failed to join the nlctrl notify group: %s\n",
+			        nl_geterror(ret));
+	}
+	
 	/* Increase buffer sizes */
 	ret = nl_socket_set_buffer_size(mgr->genl_sock, 32768, 32768);
 	if (ret < 0) {
@@ -297,6 +689,7 @@ int nlmon_nl_enable_generic(struct nlmon_nl_manager *mgr)
 	
 	/* Set up generic netlink message callback handler */
 	nl_cb_set(mgr->genl_cb, NL_CB_VALID, NL_CB_CUSTOM, nlmon_genl_msg_handler, mgr);
+	nl_cb_set(mgr->genl_cb, NL_CB_MSG_IN, NL_CB_CUSTOM, nlmon_nl_count_msg, NULL);
 	
 	mgr->enable_genl = 1;
 	
@@ -324,11 +717,13 @@ int nlmon_nl_enable_diag(struct nlmon_nl_manager *mgr)
 		return -ENOMEM;
 	}
 	
+	nlmon_nl_apply_msgpool(mgr, mgr->diag_sock);
+	
 	/* Disable sequence number checking */
 	nl_socket_disable_seq_check(mgr->diag_sock);
 	
 	/* Connect to NETLINK_SOCK_DIAG */
-	ret = nl_connect(mgr->diag_sock, NETLINK_SOCK_DIAG);
+	ret = nlmon_nl_connect(mgr, mgr->diag_sock, NETLINK_SOCK_DIAG);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to connect to NETLINK_SOCK_DIAG: %s\n",
 		        nl_geterror(ret));
@@ -337,6 +732,13 @@ int nlmon_nl_enable_diag(struct nlmon_nl_manager *mgr)
 		return ret;
 	}
 	
+	/* Drop unwanted messages before they are queued (non-fatal) */
+	ret = nlmon_nl_attach_filter(mgr, mgr->diag_sock, NETLINK_SOCK_DIAG);
+	if (ret < 0) {
+		fprintf(stderr, "Warning: Failed to attach NETLINK_SOCK_DIAG prefilter: %s\n",
+		        strerror(-ret));
+	}
+	
 	/* Increase buffer sizes */
 	ret = nl_socket_set_buffer_size(mgr->diag_sock, 32768, 32768);
 	if (ret < 0) {
@@ -368,6 +770,7 @@ int nlmon_nl_enable_diag(struct nlmon_nl_manager *mgr)
 	
 	/* Set up socket diagnostics message callback handler */
 	nl_cb_set(mgr->diag_cb, NL_CB_VALID, NL_CB_CUSTOM, nlmon_diag_msg_handler, mgr);
+	nl_cb_set(mgr->diag_cb, NL_CB_MSG_IN, NL_CB_CUSTOM, nlmon_nl_count_msg, NULL);
 	
 	mgr->enable_diag = 1;
 	
@@ -395,11 +798,13 @@ int nlmon_nl_enable_netfilter(struct nlmon_nl_manager *mgr)
 		return -ENOMEM;
 	}
 	
+	nlmon_nl_apply_msgpool(mgr, mgr->nf_sock);
+	
 	/* Disable sequence number checking */
 	nl_socket_disable_seq_check(mgr->nf_sock);
 	
 	/* Connect to NETLINK_NETFILTER */
-	ret = nl_connect(mgr->nf_sock, NETLINK_NETFILTER);
+	ret = nlmon_nl_connect(mgr, mgr->nf_sock, NETLINK_NETFILTER);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to connect to NETLINK_NETFILTER: %s\n",
 		        nl_geterror(ret));
@@ -408,6 +813,20 @@ int nlmon_nl_enable_netfilter(struct nlmon_nl_manager *mgr)
 		return ret;
 	}
 	
+	/* Drop unwanted messages before they are queued (non-fatal) */
+	ret = nlmon_nl_attach_filter(mgr, mgr->nf_sock, NETLINK_NETFILTER);
+	if (ret < 0) {
+		fprintf(stderr, "Warning: Failed to attach NETLINK_NETFILTER prefilter: %s\n",
+		        strerror(-ret));
+	}
+	
+	/* Conntrack events, only the wanted ones (non-fatal, needs CAP_NET_ADMIN) */
+	ret = nlmon_nl_join_ct_groups(mgr);
+	if (ret < 0) {
+		fprintf(stderr, "Warning: Failed to join conntrack multicast groups: %s\n",
+		        nl_geterror(ret));
+	}
+	
 	/* Increase buffer sizes */
 	ret = nl_socket_set_buffer_size(mgr->nf_sock, 32768, 32768);
 	if (ret < 0) {
@@ -439,6 +858,7 @@ int nlmon_nl_enable_netfilter(struct nlmon_nl_manager *mgr)
 	
 	/* Set up netfilter message callback handler */
 	nl_cb_set(mgr->nf_cb, NL_CB_VALID, NL_CB_CUSTOM, nlmon_nf_msg_handler, mgr);
+	nl_cb_set(mgr->nf_cb, NL_CB_MSG_IN, NL_CB_CUSTOM, nlmon_nl_count_msg, NULL);
 	
 	mgr->enable_netfilter = 1;
 	
@@ -458,8 +878,10 @@ int nlmon_nl_resolve_family(struct nlmon_nl_manager *mgr, const char *name)
 	if (!mgr->genl_sock || !mgr->enable_genl)
 		return -ENOTCONN;
 	
-	/* Resolve family name */
-	family_id = genl_ctrl_resolve(mgr->genl_sock, name);
+	/* Resolve family name, from the cache if it has it */
+	family_id = nlmon_genl_family_find(name, NULL);
+	if (family_id < 0)
+		family_id = genl_ctrl_resolve(mgr->genl_sock, name);
 	if (family_id < 0) {
 		fprintf(stderr, "Failed to resolve generic netlink family '%s': %s\n",
 		        name, nl_geterror(family_id));
@@ -534,7 +956,11 @@ int nlmon_nl_process_route(struct nlmon_nl_manager *mgr)
 		return -EINVAL;
 	
 	/* Receive and process messages using callbacks */
-	ret = nl_recvmsgs(mgr->route_sock, mgr->route_cb);
+	ret = nlmon_nl_recvmsgs(mgr, mgr->route_sock, mgr->route_cb);
+	
+	/* Receive buffer overrun - notifications were lost, recover state */
+	if (ret == -NLE_NOMEM && errno == ENOBUFS)
+		return nlmon_nl_handle_overrun(mgr, NETLINK_ROUTE);
 	
 	/* Handle non-blocking socket - no data available is not an error */
 	if (ret < 0 && (ret == -NLE_AGAIN || errno == EAGAIN || errno == EWOULDBLOCK))
@@ -576,7 +1002,11 @@ int nlmon_nl_process_genl(struct nlmon_nl_manager *mgr)
 		return -EINVAL;
 	
 	/* Receive and process messages using callbacks */
-	ret = nl_recvmsgs(mgr->genl_sock, mgr->genl_cb);
+	ret = nlmon_nl_recvmsgs(mgr, mgr->genl_sock, mgr->genl_cb);
+	
+	/* Receive buffer overrun - notifications were lost, recover state */
+	if (ret == -NLE_NOMEM && errno == ENOBUFS)
+		return nlmon_nl_handle_overrun(mgr, NETLINK_GENERIC);
 	
 	/* Handle non-blocking socket - no data available is not an error */
 	if (ret < 0 && (ret == -NLE_AGAIN || errno == EAGAIN || errno == EWOULDBLOCK))
@@ -618,7 +1048,11 @@ int nlmon_nl_process_diag(struct nlmon_nl_manager *mgr)
 		return -EINVAL;
 	
 	/* Receive and process messages using callbacks */
-	ret = nl_recvmsgs(mgr->diag_sock, mgr->diag_cb);
+	ret = nlmon_nl_recvmsgs(mgr, mgr->diag_sock, mgr->diag_cb);
+	
+	/* Receive buffer overrun - notifications were lost, recover state */
+	if (ret == -NLE_NOMEM && errno == ENOBUFS)
+		return nlmon_nl_handle_overrun(mgr, NETLINK_SOCK_DIAG);
 	
 	/* Handle non-blocking socket - no data available is not an error */
 	if (ret < 0 && (ret == -NLE_AGAIN || errno == EAGAIN || errno == EWOULDBLOCK))
@@ -643,103 +1077,905 @@ int nlmon_nl_process_diag(struct nlmon_nl_manager *mgr)
 		return ret;
 	}
 	
-	return 0;
+	return 0;
+}
+
+/**
+ * Process messages from NETLINK_NETFILTER socket
+ */
+int nlmon_nl_process_nf(struct nlmon_nl_manager *mgr)
+{
+	int ret;
+	
+	if (!mgr || !mgr->nf_sock || !mgr->enable_netfilter)
+		return -EINVAL;
+	
+	if (!mgr->nf_cb)
+		return -EINVAL;
+	
+	/* Receive and process messages using callbacks */
+	ret = nlmon_nl_recvmsgs(mgr, mgr->nf_sock, mgr->nf_cb);
+	
+	/* Receive buffer overrun - notifications were lost, recover state */
+	if (ret == -NLE_NOMEM && errno == ENOBUFS)
+		return nlmon_nl_handle_overrun(mgr, NETLINK_NETFILTER);
+	
+	/* Handle non-blocking socket - no data available is not an error */
+	if (ret < 0 && (ret == -NLE_AGAIN || errno == EAGAIN || errno == EWOULDBLOCK))
+		return 0;
+	
+	if (ret < 0) {
+		nlmon_nl_log_error("Error processing NETLINK_NETFILTER messages", ret);
+		
+		/* Check if this is a connection error */
+		if (ret == -NLE_BAD_SOCK || errno == EBADF || errno == ENOTCONN) {
+			/* Attempt to reconnect */
+			nlmon_nl_log_error("Detected connection loss, attempting reconnection", 0);
+			ret = nlmon_nl_reconnect(mgr, NETLINK_NETFILTER);
+			if (ret < 0) {
+				nlmon_nl_log_error("Reconnection failed", ret);
+				return ret;
+			}
+			/* Reconnection successful, return 0 to continue */
+			return 0;
+		}
+		
+		return ret;
+	}
+	
+	return 0;
+}
+
+/**
+ * Event callback used while receive threads are running
+ * 
+ * Runs on the receive thread. The event and its parsed payload live on
+ * the handler's stack, so both are copied into the thread's lane.
+ */
+static void nlmon_nl_rx_submit(struct nlmon_event *evt, void *user_data)
+{
+	struct nlmon_nl_manager *mgr = user_data;
+	struct nlmon_event *shared;
+	
+	/* Not called from a receive thread (e.g. cache refresh), deliver inline */
+	if (nlmon_nl_rx_lane < 0) {
+		if (mgr->rx_user_callback)
+			mgr->rx_user_callback(evt, mgr->rx_user_data);
+		return;
+	}
+	
+	/* The index references the receive buffer, decode before queueing */
+	nlmon_event_materialize(evt);
+	
+	evt->data_size = nlmon_nl_event_payload_size(evt);
+	evt->data = evt->data_size ? evt->netlink.data.generic : NULL;
+	evt->user_data = mgr;
+	
+	/* Raw message points into the receive buffer */
+	evt->raw_msg = NULL;
+	evt->raw_msg_len = 0;
+	
+	/* Event and payload share one allocation and are queued by reference */
+	shared = nlmon_event_share(evt);
+	
+	/* Drops are accounted by the event processor */
+	if (shared) {
+		event_processor_submit_lane(mgr->rx_processor, nlmon_nl_rx_lane, shared);
+		nlmon_event_put(shared);
+	} else {
+		event_processor_submit_lane(mgr->rx_processor, nlmon_nl_rx_lane, evt);
+	}
+	
+	/* The queued copy carries the trace on */
+	evt->trace.recv_ns = 0;
+	
+	/* Payload is still owned and freed by the protocol handler */
+	evt->data = NULL;
+	evt->data_size = 0;
+}
+
+/**
+ * Event processor handler delivering queued events to the user callback
+ */
+static void nlmon_nl_rx_deliver(struct nlmon_event *event, void *ctx)
+{
+	struct nlmon_nl_manager *mgr = ctx;
+	
+	/* Skip events submitted to the processor by someone else */
+	if (event->user_data != mgr || !mgr->rx_user_callback)
+		return;
+	
+	/* Point the parsed attributes at the queued copy */
+	event->netlink.data.generic = event->data;
+	
+	mgr->rx_user_callback(event, mgr->rx_user_data);
+}
+
+/**
+ * Route events through the event processor, keeping the user's callback
+ * 
+ * nlmon_nl_stop_rx_threads() restores direct delivery.
+ */
+static int nlmon_nl_rx_route_events(struct nlmon_nl_manager *mgr, struct event_processor *ep)
+{
+	mgr->rx_handler_id = event_processor_register_handler(ep, nlmon_nl_rx_deliver, mgr);
+	if (mgr->rx_handler_id < 0)
+		return -ENOMEM;
+	
+	mgr->rx_processor = ep;
+	mgr->rx_user_callback = mgr->event_callback;
+	mgr->rx_user_data = mgr->user_data;
+	mgr->event_callback = nlmon_nl_rx_submit;
+	mgr->user_data = mgr;
+	return 0;
+}
+
+/**
+ * Receive thread main loop
+ */
+static void *nlmon_nl_rx_thread_func(void *arg)
+{
+	struct nlmon_nl_rx_thread *rt = arg;
+	struct pollfd pfd[2];
+	int ret;
+	
+	nlmon_nl_rx_lane = rt->lane;
+	
+	pfd[1].fd = rt->stop_fd;
+	pfd[1].events = POLLIN;
+	
+	for (;;) {
+		/* Re-read the descriptor, reconnection replaces the socket */
+		pfd[0].fd = rt->get_fd(rt->mgr);
+		pfd[0].events = POLLIN;
+		pfd[0].revents = 0;
+		pfd[1].revents = 0;
+		
+		if (pfd[0].fd < 0)
+			break;
+		
+		ret = poll(pfd, 2, -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			nlmon_nl_log_error("Receive thread poll failed", -errno);
+			break;
+		}
+		
+		if (pfd[1].revents)
+			break;
+		
+		if (pfd[0].revents)
+			rt->process(rt->mgr);
+	}
+	
+	return NULL;
+}
+
+/**
+ * Start per-protocol receive threads
+ */
+int nlmon_nl_start_rx_threads(struct nlmon_nl_manager *mgr,
+                              struct event_processor *ep,
+                              int cpu_base)
+{
+	static const struct {
+		const char *name;
+		int (*get_fd)(struct nlmon_nl_manager *mgr);
+		int (*process)(struct nlmon_nl_manager *mgr);
+	} protocols[] = {
+		{ "nl-route", nlmon_nl_get_route_fd, nlmon_nl_process_route },
+		{ "nl-genl",  nlmon_nl_get_genl_fd,  nlmon_nl_process_genl },
+		{ "nl-diag",  nlmon_nl_get_diag_fd,  nlmon_nl_process_diag },
+		{ "nl-nf",    nlmon_nl_get_nf_fd,    nlmon_nl_process_nf },
+	};
+	const int nprotocols = sizeof(protocols) / sizeof(protocols[0]);
+	long ncpu;
+	int i, ret;
+	
+	if (!mgr || !ep || !mgr->event_callback)
+		return -EINVAL;
+	
+	if (mgr->rx_threads)
+		return -EALREADY;
+	
+	mgr->rx_threads = calloc(nprotocols, sizeof(*mgr->rx_threads));
+	if (!mgr->rx_threads)
+		return -ENOMEM;
+	
+	if (nlmon_nl_rx_route_events(mgr, ep) < 0) {
+		free(mgr->rx_threads);
+		mgr->rx_threads = NULL;
+		return -ENOMEM;
+	}
+	
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu < 1)
+		ncpu = 1;
+	
+	for (i = 0; i < nprotocols; i++) {
+		struct nlmon_nl_rx_thread *rt = &mgr->rx_threads[mgr->rx_thread_count];
+		
+		if (protocols[i].get_fd(mgr) < 0)
+			continue;
+		
+		rt->mgr = mgr;
+		rt->name = protocols[i].name;
+		rt->get_fd = protocols[i].get_fd;
+		rt->process = protocols[i].process;
+		
+		rt->lane = event_processor_add_lane(ep, 0);
+		if (rt->lane < 0) {
+			ret = -ENOSPC;
+			goto fail;
+		}
+		
+		rt->stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (rt->stop_fd < 0) {
+			ret = -errno;
+			goto fail;
+		}
+		mgr->rx_thread_count++;
+		
+		ret = pthread_create(&rt->thread, NULL, nlmon_nl_rx_thread_func, rt);
+		if (ret != 0) {
+			ret = -ret;
+			goto fail;
+		}
+		rt->started = 1;
+		
+		pthread_setname_np(rt->thread, rt->name);
+		
+		if (cpu_base >= 0) {
+			cpu_set_t cpuset;
+			
+			CPU_ZERO(&cpuset);
+			CPU_SET((cpu_base + i) % ncpu, &cpuset);
+			
+			/* Unpinned threads still work, only warn */
+			ret = pthread_setaffinity_np(rt->thread, sizeof(cpuset), &cpuset);
+			if (ret != 0)
+				nlmon_nl_log_error("Failed to pin netlink receive thread", -ret);
+		}
+	}
+	
+	return mgr->rx_thread_count;
+	
+fail:
+	nlmon_nl_log_error("Failed to start netlink receive threads", ret);
+	nlmon_nl_stop_rx_threads(mgr);
+	return ret;
+}
+
+/**
+ * io_uring receive thread main loop
+ */
+static void *nlmon_nl_rx_uring_func(void *arg)
+{
+	struct nlmon_nl_rx_thread *rt = arg;
+	int ret;
+	
+	/* Each datagram's handler selects its protocol's lane */
+	while (!atomic_load(&rt->stopping)) {
+		ret = io_recv_run(rt->recv, true);
+		if (ret < 0 && ret != -EINTR) {
+			nlmon_nl_log_error("io_uring receive failed", ret);
+			break;
+		}
+	}
+	
+	return NULL;
+}
+
+/**
+ * Start an io_uring receive thread
+ */
+int nlmon_nl_start_rx_uring(struct nlmon_nl_manager *mgr,
+                            struct event_processor *ep,
+                            int cpu)
+{
+	struct nlmon_nl_rx_thread *rt;
+	struct io_recv *rx;
+	long ncpu;
+	int i, ret;
+	
+	if (!mgr || !ep || !mgr->event_callback)
+		return -EINVAL;
+	
+	if (mgr->rx_threads || mgr->rx_recv)
+		return -EALREADY;
+	
+	rx = io_recv_create(NULL);
+	if (!rx)
+		return -errno;
+	
+	mgr->rx_threads = calloc(1, sizeof(*mgr->rx_threads));
+	if (!mgr->rx_threads) {
+		io_recv_destroy(rx);
+		return -ENOMEM;
+	}
+	
+	if (nlmon_nl_rx_route_events(mgr, ep) < 0) {
+		free(mgr->rx_threads);
+		mgr->rx_threads = NULL;
+		io_recv_destroy(rx);
+		return -ENOMEM;
+	}
+	
+	/* From here on nlmon_nl_stop_rx_threads() cleans up */
+	rt = &mgr->rx_threads[0];
+	rt->mgr = mgr;
+	rt->name = "nl-uring";
+	rt->stop_fd = -1;
+	rt->recv = rx;
+	atomic_init(&rt->stopping, 0);
+	mgr->rx_thread_count = 1;
+	
+	ret = nlmon_nl_attach_io_recv(mgr, rx);
+	if (ret <= 0) {
+		ret = ret < 0 ? ret : -ENOTCONN;
+		goto fail;
+	}
+	
+	for (i = 0; i < 4; i++) {
+		struct nlmon_nl_recv_slot *slot = &mgr->rx_recv_slots[i];
+		
+		if (slot->source < 0)
+			continue;
+		slot->lane = event_processor_add_lane(ep, 0);
+		if (slot->lane < 0) {
+			ret = -ENOSPC;
+			goto fail;
+		}
+	}
+	
+	ret = pthread_create(&rt->thread, NULL, nlmon_nl_rx_uring_func, rt);
+	if (ret != 0) {
+		ret = -ret;
+		goto fail;
+	}
+	rt->started = 1;
+	
+	pthread_setname_np(rt->thread, rt->name);
+	
+	if (cpu >= 0) {
+		cpu_set_t cpuset;
+		
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		if (ncpu < 1)
+			ncpu = 1;
+		CPU_ZERO(&cpuset);
+		CPU_SET(cpu % ncpu, &cpuset);
+		
+		/* Unpinned threads still work, only warn */
+		ret = pthread_setaffinity_np(rt->thread, sizeof(cpuset), &cpuset);
+		if (ret != 0)
+			nlmon_nl_log_error("Failed to pin netlink receive thread", -ret);
+	}
+	
+	return 1;
+	
+fail:
+	nlmon_nl_log_error("Failed to start io_uring receive thread", ret);
+	nlmon_nl_stop_rx_threads(mgr);
+	return ret;
+}
+
+/**
+ * Stop per-protocol receive threads
+ */
+void nlmon_nl_stop_rx_threads(struct nlmon_nl_manager *mgr)
+{
+	uint64_t one = 1;
+	int i;
+	
+	if (!mgr || !mgr->rx_threads)
+		return;
+	
+	for (i = 0; i < mgr->rx_thread_count; i++) {
+		struct nlmon_nl_rx_thread *rt = &mgr->rx_threads[i];
+		
+		if (!rt->started)
+			continue;
+		if (rt->recv) {
+			atomic_store(&rt->stopping, 1);
+			io_recv_wake(rt->recv);
+		} else if (write(rt->stop_fd, &one, sizeof(one)) < 0) {
+			nlmon_nl_log_error("Failed to signal netlink receive thread", -errno);
+		}
+	}
+	
+	for (i = 0; i < mgr->rx_thread_count; i++) {
+		struct nlmon_nl_rx_thread *rt = &mgr->rx_threads[i];
+		
+		if (rt->started)
+			pthread_join(rt->thread, NULL);
+		if (rt->recv) {
+			nlmon_nl_detach_io_recv(mgr);
+			io_recv_destroy(rt->recv);
+		} else {
+			close(rt->stop_fd);
+		}
+	}
+	
+	/* Deliver whatever the threads queued before handing back control */
+	event_processor_wait(mgr->rx_processor);
+	event_processor_unregister_handler(mgr->rx_processor, mgr->rx_handler_id);
+	
+	mgr->event_callback = mgr->rx_user_callback;
+	mgr->user_data = mgr->rx_user_data;
+	
+	free(mgr->rx_threads);
+	mgr->rx_threads = NULL;
+	mgr->rx_thread_count = 0;
+	mgr->rx_processor = NULL;
+	mgr->rx_handler_id = -1;
+	mgr->rx_user_callback = NULL;
+	mgr->rx_user_data = NULL;
+}
+
+/**
+ * Receive protocol sockets through an io_recv
+ */
+int nlmon_nl_attach_io_recv(struct nlmon_nl_manager *mgr, struct io_recv *rx)
+{
+	static const struct {
+		int protocol;
+		int (*get_fd)(struct nlmon_nl_manager *mgr);
+	} protocols[] = {
+		{ NETLINK_ROUTE,     nlmon_nl_get_route_fd },
+		{ NETLINK_GENERIC,   nlmon_nl_get_genl_fd },
+		{ NETLINK_SOCK_DIAG, nlmon_nl_get_diag_fd },
+		{ NETLINK_NETFILTER, nlmon_nl_get_nf_fd },
+	};
+	int i, fd, attached = 0;
+	
+	if (!mgr || !rx)
+		return -EINVAL;
+	
+	if (mgr->rx_recv)
+		return -EALREADY;
+	
+	mgr->rx_recv = rx;
+	
+	for (i = 0; i < 4; i++) {
+		struct nlmon_nl_recv_slot *slot = &mgr->rx_recv_slots[nlmon_nl_filter_slot(protocols[i].protocol)];
+		
+		slot->mgr = mgr;
+		slot->protocol = protocols[i].protocol;
+		slot->source = -1;
+		slot->lane = -1;
+		
+		fd = protocols[i].get_fd(mgr);
+		if (fd < 0 || !nlmon_nl_protocol_cb(mgr, slot->protocol))
+			continue;
+		
+		slot->source = io_recv_add(rx, fd, sizeof(struct sockaddr_nl),
+		                           nlmon_nl_recv_datagram, slot);
+		if (slot->source < 0) {
+			int ret = slot->source;
+			
+			nlmon_nl_detach_io_recv(mgr);
+			return ret;
+		}
+		attached++;
+	}
+	
+	return attached;
+}
+
+/**
+ * Stop receiving protocol sockets through an io_recv
+ */
+void nlmon_nl_detach_io_recv(struct nlmon_nl_manager *mgr)
+{
+	int i;
+	
+	if (!mgr || !mgr->rx_recv)
+		return;
+	
+	for (i = 0; i < 4; i++) {
+		struct nlmon_nl_recv_slot *slot = &mgr->rx_recv_slots[i];
+		
+		if (slot->source >= 0)
+			io_recv_set_fd(mgr->rx_recv, slot->source, -1);
+		slot->source = -1;
+		slot->lane = -1;
+	}
+	
+	mgr->rx_recv = NULL;
+}
+
+/**
+ * Move a protocol's io_recv source over to its reconnected socket
+ */
+static void nlmon_nl_recv_rebind(struct nlmon_nl_manager *mgr, int protocol)
+{
+	int index = nlmon_nl_filter_slot(protocol);
+	struct nl_sock *sk = nlmon_nl_protocol_sock(mgr, protocol);
+	
+	if (!mgr->rx_recv || index < 0 || mgr->rx_recv_slots[index].source < 0 || !sk)
+		return;
+	
+	io_recv_set_fd(mgr->rx_recv, mgr->rx_recv_slots[index].source, nl_socket_get_fd(sk));
+}
+
+/**
+ * Set event callback for netlink events
+ */
+void nlmon_nl_set_callback(struct nlmon_nl_manager *mgr,
+                           void (*cb)(struct nlmon_event *, void *),
+                           void *user_data)
+{
+	if (!mgr)
+		return;
+	
+	/* Receive threads own event_callback, replace the delivered-to one */
+	if (mgr->rx_threads) {
+		mgr->rx_user_callback = cb;
+		mgr->rx_user_data = user_data;
+		return;
+	}
+	
+	mgr->event_callback = cb;
+	mgr->user_data = user_data;
+}
+
+/**
+ * Set the buffer pool the protocol sockets receive into
+ */
+int nlmon_nl_set_msgpool(struct nlmon_nl_manager *mgr, struct nlmon_nl_msgpool *pool)
+{
+	if (!mgr)
+		return -EINVAL;
+	
+	if (pool == mgr->rx_pool)
+		return 0;
+	
+	if (mgr->rx_pool_owned)
+		nlmon_nl_msgpool_destroy(mgr->rx_pool);
+	mgr->rx_pool = pool;
+	mgr->rx_pool_owned = 0;
+	
+	nlmon_nl_apply_msgpool(mgr, mgr->route_sock);
+	nlmon_nl_apply_msgpool(mgr, mgr->genl_sock);
+	nlmon_nl_apply_msgpool(mgr, mgr->diag_sock);
+	nlmon_nl_apply_msgpool(mgr, mgr->nf_sock);
+	return 0;
+}
+
+uint64_t nlmon_nl_recv_timestamp(void)
+{
+	return nlmon_nl_recv_stamp ? nlmon_nl_recv_stamp : nlmon_clock_realtime_ns();
+}
+
+/**
+ * Hand an event decoded by a protocol handler to the event callback
+ */
+void nlmon_nl_deliver_event(struct nlmon_nl_manager *mgr, struct nlmon_event *evt)
+{
+	if (!mgr->event_callback)
+		return;
+	
+	/* Updates repeating the last state of their object stop here */
+	if (mgr->delta && !nlmon_nl_delta_check(mgr->delta, evt))
+		return;
+	
+	nlmon_trace_begin(&evt->trace, nlmon_nl_recv_ns);
+	nlmon_trace_stamp(&evt->trace, NLMON_TRACE_PARSE);
+	
+	mgr->event_callback(evt, mgr->user_data);
+	
+	/* Still ours unless the callback queued it, see nlmon_nl_rx_submit() */
+	nlmon_trace_finish(&evt->trace, NLMON_TRACE_HANDLER);
+}
+
+/**
+ * Attach resource limits tracker
+ */
+void nlmon_nl_set_limits(struct nlmon_nl_manager *mgr, struct nlmon_nl_limits *limits)
+{
+	if (!mgr)
+		return;
+	
+	mgr->limits = limits;
+}
+
+/**
+ * Attach a digest table
+ */
+void nlmon_nl_set_delta(struct nlmon_nl_manager *mgr, struct nlmon_nl_delta *delta)
+{
+	if (!mgr)
+		return;
+	
+	mgr->delta = delta;
+}
+
+/* Prefilter slot of a protocol */
+static int nlmon_nl_filter_slot(int protocol)
+{
+	switch (protocol) {
+	case NETLINK_ROUTE:
+		return 0;
+	case NETLINK_GENERIC:
+		return 1;
+	case NETLINK_SOCK_DIAG:
+		return 2;
+	case NETLINK_NETFILTER:
+		return 3;
+	default:
+		return -1;
+	}
+}
+
+/**
+ * Connect a protocol socket, to the adopted one if there is one
+ */
+static int nlmon_nl_connect(struct nlmon_nl_manager *mgr, struct nl_sock *sk, int protocol)
+{
+	int index = nlmon_nl_filter_slot(protocol);
+	int ret;
+	
+	if (index < 0 || mgr->adopt_fds[index] < 0)
+		return nl_connect(sk, protocol);
+	
+	ret = nl_connect_fd(sk, protocol, mgr->adopt_fds[index]);
+	if (ret < 0) {
+		nlmon_nl_log_error("Adopted netlink socket unusable, opening a new one", ret);
+		close(mgr->adopt_fds[index]);
+		mgr->adopt_fds[index] = -1;
+		return nl_connect(sk, protocol);
+	}
+	
+	/* The socket is the manager's now */
+	mgr->adopt_fds[index] = -1;
+	return 0;
+}
+
+/**
+ * Use a socket of another process for a protocol
+ */
+int nlmon_nl_adopt_socket(struct nlmon_nl_manager *mgr, int protocol, int fd)
+{
+	int index = nlmon_nl_filter_slot(protocol);
+	
+	if (!mgr || index < 0 || fd < 0)
+		return -EINVAL;
+	if (nlmon_nl_protocol_sock(mgr, protocol))
+		return -EALREADY;
+	
+	if (mgr->adopt_fds[index] >= 0)
+		close(mgr->adopt_fds[index]);
+	mgr->adopt_fds[index] = fd;
+	return 0;
+}
+
+static struct nl_sock *nlmon_nl_protocol_sock(struct nlmon_nl_manager *mgr, int protocol)
+{
+	switch (protocol) {
+	case NETLINK_ROUTE:
+		return mgr->route_sock;
+	case NETLINK_GENERIC:
+		return mgr->genl_sock;
+	case NETLINK_SOCK_DIAG:
+		return mgr->diag_sock;
+	case NETLINK_NETFILTER:
+		return mgr->nf_sock;
+	default:
+		return NULL;
+	}
+}
+
+static struct nl_cb *nlmon_nl_protocol_cb(struct nlmon_nl_manager *mgr, int protocol)
+{
+	switch (protocol) {
+	case NETLINK_ROUTE:
+		return mgr->route_cb;
+	case NETLINK_GENERIC:
+		return mgr->genl_cb;
+	case NETLINK_SOCK_DIAG:
+		return mgr->diag_cb;
+	case NETLINK_NETFILTER:
+		return mgr->nf_cb;
+	default:
+		return NULL;
+	}
+}
+
+/* Instructions added around a prefilter by nlmon_nl_attach_filter() */
+#define NLMON_NL_FILTER_WRAP 6
+
+/**
+ * Attach the stored prefilter of a protocol to its socket
+ */
+static int nlmon_nl_attach_filter(struct nlmon_nl_manager *mgr, struct nl_sock *sk,
+                                  int protocol)
+{
+	const struct sock_filter *pre = NULL;
+	unsigned short pre_len = 0;
+	struct sock_filter *prog;
+	struct sock_fprog fprog;
+	unsigned short len;
+	int slot;
+	int ret = 0;
+	
+	slot = nlmon_nl_filter_slot(protocol);
+	if (slot < 0 || !sk)
+		return -EINVAL;
+	
+	/* Conntrack narrowing rejects first and falls through to the prefilter */
+	if (protocol == NETLINK_NETFILTER) {
+		pre = mgr->ct_prog;
+		pre_len = mgr->ct_prog_len;
+	}
+	
+	if (!mgr->filters[slot] && !pre)
+		return 0;
+	
+	len = pre_len + mgr->filter_lens[slot];
+	prog = malloc((len + NLMON_NL_FILTER_WRAP) * sizeof(*prog));
+	if (!prog)
+		return -ENOMEM;
+	
+	/* Replies to this socket's own requests bypass the prefilter */
+	prog[0] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0);
+	prog[1] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, NLMSG_HDRLEN, 0, 2);
+	prog[2] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+	                                       offsetof(struct nlmsghdr, nlmsg_pid));
+	prog[3] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+	                                       htonl(nl_socket_get_local_port(sk)), 0, 1);
+	prog[4] = (struct sock_filter)BPF_STMT(BPF_JMP | BPF_JA, len);
+	if (pre_len)
+		memcpy(prog + 5, pre, pre_len * sizeof(*prog));
+	if (mgr->filters[slot])
+		memcpy(prog + 5 + pre_len, mgr->filters[slot],
+		       mgr->filter_lens[slot] * sizeof(*prog));
+	prog[5 + len] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+	
+	fprog.len = len + NLMON_NL_FILTER_WRAP;
+	fprog.filter = prog;
+	if (setsockopt(nl_socket_get_fd(sk), SOL_SOCKET, SO_ATTACH_FILTER,
+	               &fprog, sizeof(fprog)) < 0)
+		ret = -errno;
+	
+	free(prog);
+	return ret;
 }
 
 /**
- * Process messages from NETLINK_NETFILTER socket
+ * Enable or disable lazy decoding of NETLINK_ROUTE events
  */
-int nlmon_nl_process_nf(struct nlmon_nl_manager *mgr)
+void nlmon_nl_set_lazy_decode(struct nlmon_nl_manager *mgr, int enable)
 {
-	int ret;
+	if (mgr)
+		mgr->lazy_decode = enable ? 1 : 0;
+}
+
+/**
+ * Attach a classic BPF prefilter to a protocol's socket
+ */
+int nlmon_nl_set_filter(struct nlmon_nl_manager *mgr, int protocol,
+                        const struct sock_filter *insns, unsigned short len)
+{
+	struct sock_filter *copy = NULL;
+	struct nl_sock *sk;
+	int slot;
 	
-	if (!mgr || !mgr->nf_sock || !mgr->enable_netfilter)
+	if (!mgr)
 		return -EINVAL;
 	
-	if (!mgr->nf_cb)
+	slot = nlmon_nl_filter_slot(protocol);
+	if (slot < 0)
 		return -EINVAL;
 	
-	/* Receive and process messages using callbacks */
-	ret = nl_recvmsgs(mgr->nf_sock, mgr->nf_cb);
+	if (insns && len > 0) {
+		/* Leave room for the conntrack narrowing in front of it */
+		if (len > BPF_MAXINSNS - NLMON_NL_FILTER_WRAP - NLMON_CT_FILTER_MAX_INSNS)
+			return -E2BIG;
+		copy = malloc(len * sizeof(*copy));
+		if (!copy)
+			return -ENOMEM;
+		memcpy(copy, insns, len * sizeof(*copy));
+	} else {
+		len = 0;
+	}
 	
-	/* Handle non-blocking socket - no data available is not an error */
-	if (ret < 0 && (ret == -NLE_AGAIN || errno == EAGAIN || errno == EWOULDBLOCK))
+	free(mgr->filters[slot]);
+	mgr->filters[slot] = copy;
+	mgr->filter_lens[slot] = len;
+	
+	sk = nlmon_nl_protocol_sock(mgr, protocol);
+	if (!sk)
 		return 0;
 	
-	if (ret < 0) {
-		nlmon_nl_log_error("Error processing NETLINK_NETFILTER messages", ret);
-		
-		/* Check if this is a connection error */
-		if (ret == -NLE_BAD_SOCK || errno == EBADF || errno == ENOTCONN) {
-			/* Attempt to reconnect */
-			nlmon_nl_log_error("Detected connection loss, attempting reconnection", 0);
-			ret = nlmon_nl_reconnect(mgr, NETLINK_NETFILTER);
-			if (ret < 0) {
-				nlmon_nl_log_error("Reconnection failed", ret);
-				return ret;
-			}
-			/* Reconnection successful, return 0 to continue */
-			return 0;
+	if (!copy && !(protocol == NETLINK_NETFILTER && mgr->ct_prog)) {
+		setsockopt(nl_socket_get_fd(sk), SOL_SOCKET, SO_DETACH_FILTER, NULL, 0);
+		return 0;
+	}
+	
+	return nlmon_nl_attach_filter(mgr, sk, protocol);
+}
+
+/* Join the conntrack groups of the wanted events and leave the others */
+static int nlmon_nl_join_ct_groups(struct nlmon_nl_manager *mgr)
+{
+	static const struct {
+		uint32_t event;
+		int group;
+	} groups[] = {
+		{ NLMON_CT_EVENT_NEW,     NFNLGRP_CONNTRACK_NEW },
+		{ NLMON_CT_EVENT_UPDATE,  NFNLGRP_CONNTRACK_UPDATE },
+		{ NLMON_CT_EVENT_DESTROY, NFNLGRP_CONNTRACK_DESTROY },
+	};
+	size_t i;
+	int ret;
+	
+	for (i = 0; i < sizeof(groups) / sizeof(groups[0]); i++) {
+		if (!(mgr->ct_events & groups[i].event)) {
+			nl_socket_drop_membership(mgr->nf_sock, groups[i].group);
+			continue;
 		}
 		
-		return ret;
+		ret = nl_socket_add_membership(mgr->nf_sock, groups[i].group);
+		if (ret < 0)
+			return ret;
 	}
 	
 	return 0;
 }
 
 /**
- * Set event callback for netlink events
+ * Narrow the conntrack events received by a manager
  */
-void nlmon_nl_set_callback(struct nlmon_nl_manager *mgr,
-                           void (*cb)(struct nlmon_event *, void *),
-                           void *user_data)
+int nlmon_nl_set_ct_filter(struct nlmon_nl_manager *mgr, const struct nlmon_ct_filter *filter)
 {
+	struct sock_filter insns[NLMON_CT_FILTER_MAX_INSNS];
+	struct sock_filter *copy = NULL;
+	uint32_t events = NLMON_CT_EVENT_ALL;
+	int len = 0;
+	int ret;
+	
 	if (!mgr)
-		return;
+		return -EINVAL;
 	
-	mgr->event_callback = cb;
-	mgr->user_data = user_data;
+	if (filter) {
+		if (filter->events & ~NLMON_CT_EVENT_ALL)
+			return -EINVAL;
+		if (filter->events)
+			events = filter->events;
+		
+		len = nlmon_ct_filter_compile(filter, insns, NLMON_CT_FILTER_MAX_INSNS);
+		if (len < 0)
+			return len;
+		if (len > 0) {
+			copy = malloc(len * sizeof(*copy));
+			if (!copy)
+				return -ENOMEM;
+			memcpy(copy, insns, len * sizeof(*copy));
+		}
+	}
+	
+	free(mgr->ct_prog);
+	mgr->ct_prog = copy;
+	mgr->ct_prog_len = len;
+	mgr->ct_events = events;
+	
+	if (!mgr->nf_sock)
+		return 0;
+	
+	ret = nlmon_nl_join_ct_groups(mgr);
+	if (ret < 0)
+		return ret;
+	
+	if (!copy && !mgr->filters[nlmon_nl_filter_slot(NETLINK_NETFILTER)]) {
+		setsockopt(nl_socket_get_fd(mgr->nf_sock), SOL_SOCKET, SO_DETACH_FILTER, NULL, 0);
+		return 0;
+	}
+	
+	return nlmon_nl_attach_filter(mgr, mgr->nf_sock, NETLINK_NETFILTER);
 }
 
-/**
- * Cache operations structure for link cache
- * 
- * Defines how to request and parse link (interface) information.
- */
-static struct nl_cache_ops link_cache_ops = {
-	.co_name = "route/link",
-	.co_protocol = NETLINK_ROUTE,
-	.co_hdrsize = sizeof(struct ifinfomsg),
-	.co_request_update = NULL,  /* We'll handle this manually */
-	.co_msg_parser = NULL,      /* We'll handle this manually */
-	.co_obj_ops = NULL,
-};
-
-/**
- * Cache operations structure for address cache
- */
-static struct nl_cache_ops addr_cache_ops = {
-	.co_name = "route/addr",
-	.co_protocol = NETLINK_ROUTE,
-	.co_hdrsize = sizeof(struct ifaddrmsg),
-	.co_request_update = NULL,
-	.co_msg_parser = NULL,
-	.co_obj_ops = NULL,
-};
-
-/**
- * Cache operations structure for route cache
- */
-static struct nl_cache_ops route_cache_ops = {
-	.co_name = "route/route",
-	.co_protocol = NETLINK_ROUTE,
-	.co_hdrsize = sizeof(struct rtmsg),
-	.co_request_update = NULL,
-	.co_msg_parser = NULL,
-	.co_obj_ops = NULL,
-};
-
 /**
  * Request link dump from kernel
  */
@@ -809,6 +2045,315 @@ static int request_route_dump(struct nl_sock *sk)
 	                      &req.rtm, sizeof(req.rtm));
 }
 
+/*
+ * Cached objects
+ * 
+ * Each keeps the attributes the kernel identifies it by, so updates and
+ * deletions find the cached copy through the cache's identity index
+ * instead of a walk over every object.
+ */
+#define CACHE_ATTR_ID 0x1
+
+struct nlmon_cache_link {
+	NLHDR_COMMON
+	int ifindex;
+	unsigned int flags;
+	char name[IFNAMSIZ];
+};
+
+struct nlmon_cache_addr {
+	NLHDR_COMMON
+	int ifindex;
+	uint8_t family;
+	uint8_t prefixlen;
+	uint8_t local[16];
+	char label[IFNAMSIZ];
+};
+
+struct nlmon_cache_route {
+	NLHDR_COMMON
+	uint8_t family;
+	uint8_t dst_len;
+	uint8_t tos;
+	uint32_t table;
+	uint32_t priority;
+	uint8_t dst[16];
+	int oif;
+};
+
+/* FNV-1a over identity fields */
+static uint32_t cache_key_hash(uint32_t hash, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	
+	while (len--)
+		hash = (hash ^ *p++) * 16777619u;
+	return hash;
+}
+
+#define CACHE_KEY_SEED 2166136261u
+
+static uint32_t link_keygen(struct nl_object *obj)
+{
+	struct nlmon_cache_link *link = (struct nlmon_cache_link *)obj;
+	
+	return cache_key_hash(CACHE_KEY_SEED, &link->ifindex, sizeof(link->ifindex));
+}
+
+static int link_compare(struct nl_object *a, struct nl_object *b, uint32_t attrs, int flags)
+{
+	struct nlmon_cache_link *la = (struct nlmon_cache_link *)a;
+	struct nlmon_cache_link *lb = (struct nlmon_cache_link *)b;
+	
+	(void)flags;
+	return (attrs & CACHE_ATTR_ID) && la->ifindex != lb->ifindex ? CACHE_ATTR_ID : 0;
+}
+
+static uint32_t addr_keygen(struct nl_object *obj)
+{
+	struct nlmon_cache_addr *addr = (struct nlmon_cache_addr *)obj;
+	uint32_t hash = CACHE_KEY_SEED;
+	
+	hash = cache_key_hash(hash, &addr->ifindex, sizeof(addr->ifindex));
+	hash = cache_key_hash(hash, &addr->family, sizeof(addr->family));
+	hash = cache_key_hash(hash, &addr->prefixlen, sizeof(addr->prefixlen));
+	return cache_key_hash(hash, addr->local, sizeof(addr->local));
+}
+
+static int addr_compare(struct nl_object *a, struct nl_object *b, uint32_t attrs, int flags)
+{
+	struct nlmon_cache_addr *aa = (struct nlmon_cache_addr *)a;
+	struct nlmon_cache_addr *ab = (struct nlmon_cache_addr *)b;
+	
+	(void)flags;
+	if (!(attrs & CACHE_ATTR_ID))
+		return 0;
+	return aa->ifindex != ab->ifindex || aa->family != ab->family ||
+	       aa->prefixlen != ab->prefixlen ||
+	       memcmp(aa->local, ab->local, sizeof(aa->local)) ? CACHE_ATTR_ID : 0;
+}
+
+static uint32_t route_keygen(struct nl_object *obj)
+{
+	struct nlmon_cache_route *route = (struct nlmon_cache_route *)obj;
+	uint32_t hash = CACHE_KEY_SEED;
+	
+	hash = cache_key_hash(hash, &route->family, sizeof(route->family));
+	hash = cache_key_hash(hash, &route->dst_len, sizeof(route->dst_len));
+	hash = cache_key_hash(hash, &route->tos, sizeof(route->tos));
+	hash = cache_key_hash(hash, &route->table, sizeof(route->table));
+	hash = cache_key_hash(hash, &route->priority, sizeof(route->priority));
+	return cache_key_hash(hash, route->dst, sizeof(route->dst));
+}
+
+static int route_compare(struct nl_object *a, struct nl_object *b, uint32_t attrs, int flags)
+{
+	struct nlmon_cache_route *ra = (struct nlmon_cache_route *)a;
+	struct nlmon_cache_route *rb = (struct nlmon_cache_route *)b;
+	
+	(void)flags;
+	if (!(attrs & CACHE_ATTR_ID))
+		return 0;
+	return ra->family != rb->family || ra->dst_len != rb->dst_len ||
+	       ra->tos != rb->tos || ra->table != rb->table ||
+	       ra->priority != rb->priority ||
+	       memcmp(ra->dst, rb->dst, sizeof(ra->dst)) ? CACHE_ATTR_ID : 0;
+}
+
+static struct nl_object_ops link_obj_ops = {
+	.oo_name = "route/link",
+	.oo_size = sizeof(struct nlmon_cache_link),
+	.oo_id_attrs = CACHE_ATTR_ID,
+	.oo_compare = link_compare,
+	.oo_keygen = link_keygen,
+};
+
+static struct nl_object_ops addr_obj_ops = {
+	.oo_name = "route/addr",
+	.oo_size = sizeof(struct nlmon_cache_addr),
+	.oo_id_attrs = CACHE_ATTR_ID,
+	.oo_compare = addr_compare,
+	.oo_keygen = addr_keygen,
+};
+
+static struct nl_object_ops route_obj_ops = {
+	.oo_name = "route/route",
+	.oo_size = sizeof(struct nlmon_cache_route),
+	.oo_id_attrs = CACHE_ATTR_ID,
+	.oo_compare = route_compare,
+	.oo_keygen = route_keygen,
+};
+
+/* Hand a parsed object to the cache and drop the parser's reference */
+static int cache_deliver(struct nl_object *obj, struct nlmsghdr *nlh,
+                         struct nl_parser_param *pp)
+{
+	int err;
+	
+	obj->ce_msgtype = nlh->nlmsg_type;
+	obj->ce_mask = CACHE_ATTR_ID;
+	err = pp->pp_cb(obj, pp);
+	nl_object_put(obj);
+	return err;
+}
+
+static int link_msg_parser(struct nl_cache_ops *ops, struct sockaddr_nl *who,
+                           struct nlmsghdr *nlh, struct nl_parser_param *pp)
+{
+	struct ifinfomsg *ifi = nlmsg_data(nlh);
+	struct nlmon_cache_link *link;
+	struct nlattr *nla;
+	
+	(void)who;
+	link = (struct nlmon_cache_link *)nl_object_alloc(ops->co_obj_ops);
+	if (!link)
+		return -NLE_NOMEM;
+	
+	link->ifindex = ifi->ifi_index;
+	link->flags = ifi->ifi_flags;
+	nla = nlmsg_find_attr(nlh, sizeof(*ifi), IFLA_IFNAME);
+	if (nla)
+		nla_strlcpy(link->name, nla, sizeof(link->name));
+	
+	return cache_deliver((struct nl_object *)link, nlh, pp);
+}
+
+static int addr_msg_parser(struct nl_cache_ops *ops, struct sockaddr_nl *who,
+                           struct nlmsghdr *nlh, struct nl_parser_param *pp)
+{
+	struct ifaddrmsg *ifa = nlmsg_data(nlh);
+	struct nlmon_cache_addr *addr;
+	struct nlattr *nla;
+	
+	(void)who;
+	addr = (struct nlmon_cache_addr *)nl_object_alloc(ops->co_obj_ops);
+	if (!addr)
+		return -NLE_NOMEM;
+	
+	addr->ifindex = ifa->ifa_index;
+	addr->family = ifa->ifa_family;
+	addr->prefixlen = ifa->ifa_prefixlen;
+	
+	/* IFA_LOCAL is the address on point-to-point links */
+	nla = nlmsg_find_attr(nlh, sizeof(*ifa), IFA_LOCAL);
+	if (!nla)
+		nla = nlmsg_find_attr(nlh, sizeof(*ifa), IFA_ADDRESS);
+	if (nla)
+		nla_memcpy(addr->local, nla, sizeof(addr->local));
+	nla = nlmsg_find_attr(nlh, sizeof(*ifa), IFA_LABEL);
+	if (nla)
+		nla_strlcpy(addr->label, nla, sizeof(addr->label));
+	
+	return cache_deliver((struct nl_object *)addr, nlh, pp);
+}
+
+static int route_msg_parser(struct nl_cache_ops *ops, struct sockaddr_nl *who,
+                            struct nlmsghdr *nlh, struct nl_parser_param *pp)
+{
+	struct rtmsg *rtm = nlmsg_data(nlh);
+	struct nlmon_cache_route *route;
+	struct nlattr *nla;
+	
+	(void)who;
+	route = (struct nlmon_cache_route *)nl_object_alloc(ops->co_obj_ops);
+	if (!route)
+		return -NLE_NOMEM;
+	
+	route->family = rtm->rtm_family;
+	route->dst_len = rtm->rtm_dst_len;
+	route->tos = rtm->rtm_tos;
+	route->table = rtm->rtm_table;
+	
+	nla = nlmsg_find_attr(nlh, sizeof(*rtm), RTA_TABLE);
+	if (nla && nla_len(nla) >= (int)sizeof(uint32_t))
+		route->table = nla_get_u32(nla);
+	nla = nlmsg_find_attr(nlh, sizeof(*rtm), RTA_PRIORITY);
+	if (nla && nla_len(nla) >= (int)sizeof(uint32_t))
+		route->priority = nla_get_u32(nla);
+	nla = nlmsg_find_attr(nlh, sizeof(*rtm), RTA_OIF);
+	if (nla && nla_len(nla) >= (int)sizeof(uint32_t))
+		route->oif = nla_get_u32(nla);
+	nla = nlmsg_find_attr(nlh, sizeof(*rtm), RTA_DST);
+	if (nla)
+		nla_memcpy(route->dst, nla, sizeof(route->dst));
+	
+	return cache_deliver((struct nl_object *)route, nlh, pp);
+}
+
+static int link_request_update(struct nl_cache *cache, struct nl_sock *sk)
+{
+	(void)cache;
+	return request_link_dump(sk);
+}
+
+static int addr_request_update(struct nl_cache *cache, struct nl_sock *sk)
+{
+	(void)cache;
+	return request_addr_dump(sk);
+}
+
+static int route_request_update(struct nl_cache *cache, struct nl_sock *sk)
+{
+	(void)cache;
+	return request_route_dump(sk);
+}
+
+/**
+ * Cache operations structure for link cache
+ * 
+ * Defines how to request and parse link (interface) information.
+ */
+static struct nl_cache_ops link_cache_ops = {
+	.co_name = "route/link",
+	.co_protocol = NETLINK_ROUTE,
+	.co_hdrsize = sizeof(struct ifinfomsg),
+	.co_request_update = link_request_update,
+	.co_msg_parser = link_msg_parser,
+	.co_obj_ops = &link_obj_ops,
+	.co_msgtypes = {
+		{ RTM_NEWLINK, NL_ACT_NEW, "new" },
+		{ RTM_DELLINK, NL_ACT_DEL, "del" },
+		{ RTM_GETLINK, NL_ACT_GET, "get" },
+		END_OF_MSGTYPES_LIST,
+	},
+};
+
+/**
+ * Cache operations structure for address cache
+ */
+static struct nl_cache_ops addr_cache_ops = {
+	.co_name = "route/addr",
+	.co_protocol = NETLINK_ROUTE,
+	.co_hdrsize = sizeof(struct ifaddrmsg),
+	.co_request_update = addr_request_update,
+	.co_msg_parser = addr_msg_parser,
+	.co_obj_ops = &addr_obj_ops,
+	.co_msgtypes = {
+		{ RTM_NEWADDR, NL_ACT_NEW, "new" },
+		{ RTM_DELADDR, NL_ACT_DEL, "del" },
+		{ RTM_GETADDR, NL_ACT_GET, "get" },
+		END_OF_MSGTYPES_LIST,
+	},
+};
+
+/**
+ * Cache operations structure for route cache
+ */
+static struct nl_cache_ops route_cache_ops = {
+	.co_name = "route/route",
+	.co_protocol = NETLINK_ROUTE,
+	.co_hdrsize = sizeof(struct rtmsg),
+	.co_request_update = route_request_update,
+	.co_msg_parser = route_msg_parser,
+	.co_obj_ops = &route_obj_ops,
+	.co_msgtypes = {
+		{ RTM_NEWROUTE, NL_ACT_NEW, "new" },
+		{ RTM_DELROUTE, NL_ACT_DEL, "del" },
+		{ RTM_GETROUTE, NL_ACT_GET, "get" },
+		END_OF_MSGTYPES_LIST,
+	},
+};
+
 /**
  * Initialize link cache
  */
@@ -998,19 +2543,11 @@ int nlmon_nl_cache_update_link(struct nlmon_nl_manager *mgr, struct nl_msg *msg)
 		return 0;
 	
 	nlh = nlmsg_hdr(msg);
-	
-	/* Parse and add to cache */
-	if (nlh->nlmsg_type == RTM_NEWLINK) {
-		/* For simplicity, we'll just parse and add the message to cache
-		 * In a full implementation, we would create proper nl_object structures */
-		return nl_cache_parse_and_add(mgr->link_cache, msg);
-	} else if (nlh->nlmsg_type == RTM_DELLINK) {
-		/* For deletion, we would need to find and remove the object
-		 * This is simplified - in production we'd search by ifindex */
+	if (nlh->nlmsg_type != RTM_NEWLINK && nlh->nlmsg_type != RTM_DELLINK)
 		return 0;
-	}
 	
-	return 0;
+	/* Replaces or removes the cached object with the same identity */
+	return nl_cache_parse_and_include(mgr->link_cache, msg, NULL);
 }
 
 /**
@@ -1034,16 +2571,11 @@ int nlmon_nl_cache_update_addr(struct nlmon_nl_manager *mgr, struct nl_msg *msg)
 		return 0;
 	
 	nlh = nlmsg_hdr(msg);
-	
-	/* Parse and add to cache */
-	if (nlh->nlmsg_type == RTM_NEWADDR) {
-		return nl_cache_parse_and_add(mgr->addr_cache, msg);
-	} else if (nlh->nlmsg_type == RTM_DELADDR) {
-		/* For deletion, we would need to find and remove the object */
+	if (nlh->nlmsg_type != RTM_NEWADDR && nlh->nlmsg_type != RTM_DELADDR)
 		return 0;
-	}
 	
-	return 0;
+	/* Replaces or removes the cached object with the same identity */
+	return nl_cache_parse_and_include(mgr->addr_cache, msg, NULL);
 }
 
 /**
@@ -1067,16 +2599,11 @@ int nlmon_nl_cache_update_route(struct nlmon_nl_manager *mgr, struct nl_msg *msg
 		return 0;
 	
 	nlh = nlmsg_hdr(msg);
-	
-	/* Parse and add to cache */
-	if (nlh->nlmsg_type == RTM_NEWROUTE) {
-		return nl_cache_parse_and_add(mgr->route_cache, msg);
-	} else if (nlh->nlmsg_type == RTM_DELROUTE) {
-		/* For deletion, we would need to find and remove the object */
+	if (nlh->nlmsg_type != RTM_NEWROUTE && nlh->nlmsg_type != RTM_DELROUTE)
 		return 0;
-	}
 	
-	return 0;
+	/* Replaces or removes the cached object with the same identity */
+	return nl_cache_parse_and_include(mgr->route_cache, msg, NULL);
 }
 
 /**
@@ -1153,6 +2680,35 @@ int nlmon_nl_get_route_count(struct nlmon_nl_manager *mgr)
 	return nl_cache_nitems(mgr->route_cache);
 }
 
+/**
+ * Apply the conntrack section of a configuration
+ */
+int nlmon_nl_apply_ct_config(struct nlmon_nl_manager *mgr,
+                             const struct nlmon_netlink_config *config)
+{
+	struct nlmon_ct_filter filter;
+	
+	if (!mgr || !config)
+		return -EINVAL;
+	
+	memset(&filter, 0, sizeof(filter));
+	filter.l3proto = config->conntrack.l3proto;
+	filter.l4proto = config->conntrack.l4proto;
+	filter.match_zone = config->conntrack.zone >= 0;
+	filter.zone = config->conntrack.zone >= 0 ? config->conntrack.zone : 0;
+	filter.mark = config->conntrack.mark;
+	filter.mark_mask = config->conntrack.mark_mask;
+	
+	if (config->conntrack.events_new)
+		filter.events |= NLMON_CT_EVENT_NEW;
+	if (config->conntrack.events_update)
+		filter.events |= NLMON_CT_EVENT_UPDATE;
+	if (config->conntrack.events_destroy)
+		filter.events |= NLMON_CT_EVENT_DESTROY;
+	
+	return nlmon_nl_set_ct_filter(mgr, &filter);
+}
+
 /**
  * Apply configuration to netlink manager
  * 
@@ -1168,6 +2724,17 @@ int nlmon_nl_apply_config(struct nlmon_nl_manager *mgr,
 	if (!mgr || !config)
 		return -EINVAL;
 	
+	/* Receive buffer autotuning starts from the configured size */
+	if (mgr->limits) {
+		struct nlmon_nl_autotune_config autotune = {
+			.enabled = config->buffer_size.autotune,
+			.min_rcvbuf = config->buffer_size.receive,
+			.max_rcvbuf = config->buffer_size.receive_max,
+		};
+		
+		nlmon_nl_limits_set_autotune(mgr->limits, &autotune);
+	}
+	
 	/* Enable protocols based on configuration */
 	if (config->protocols.route) {
 		ret = nlmon_nl_enable_route(mgr);
@@ -1247,6 +2814,13 @@ int nlmon_nl_apply_config(struct nlmon_nl_manager *mgr,
 	}
 	
 	if (config->protocols.netfilter) {
+		/* Narrow conntrack events before the socket joins any group */
+		ret = nlmon_nl_apply_ct_config(mgr, config);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to set conntrack filter: %s\n", strerror(-ret));
+			return ret;
+		}
+		
 		ret = nlmon_nl_enable_netfilter(mgr);
 		if (ret < 0) {
 			fprintf(stderr, "Failed to enable NETLINK_NETFILTER: %s\n",
@@ -1331,6 +2905,7 @@ static int reconnect_route_socket(struct nlmon_nl_manager *mgr)
 	
 	/* Close existing socket if present */
 	if (mgr->route_sock) {
+		nlmon_nl_limits_forget_socket(mgr->limits, nl_socket_get_fd(mgr->route_sock));
 		nl_close(mgr->route_sock);
 		nl_socket_free(mgr->route_sock);
 		mgr->route_sock = NULL;
@@ -1370,6 +2945,7 @@ static int reconnect_genl_socket(struct nlmon_nl_manager *mgr)
 	
 	/* Close existing socket if present */
 	if (mgr->genl_sock) {
+		nlmon_nl_limits_forget_socket(mgr->limits, nl_socket_get_fd(mgr->genl_sock));
 		nl_close(mgr->genl_sock);
 		nl_socket_free(mgr->genl_sock);
 		mgr->genl_sock = NULL;
@@ -1413,6 +2989,7 @@ static int reconnect_diag_socket(struct nlmon_nl_manager *mgr)
 	
 	/* Close existing socket if present */
 	if (mgr->diag_sock) {
+		nlmon_nl_limits_forget_socket(mgr->limits, nl_socket_get_fd(mgr->diag_sock));
 		nl_close(mgr->diag_sock);
 		nl_socket_free(mgr->diag_sock);
 		mgr->diag_sock = NULL;
@@ -1452,6 +3029,7 @@ static int reconnect_nf_socket(struct nlmon_nl_manager *mgr)
 	
 	/* Close existing socket if present */
 	if (mgr->nf_sock) {
+		nlmon_nl_limits_forget_socket(mgr->limits, nl_socket_get_fd(mgr->nf_sock));
 		nl_close(mgr->nf_sock);
 		nl_socket_free(mgr->nf_sock);
 		mgr->nf_sock = NULL;
@@ -1477,33 +3055,67 @@ static int reconnect_nf_socket(struct nlmon_nl_manager *mgr)
 	return 0;
 }
 
-/**
- * Reconnect a netlink socket after connection loss
- */
-int nlmon_nl_reconnect(struct nlmon_nl_manager *mgr, int protocol)
+/* Reopen a protocol socket in the namespace of the calling thread */
+static int reconnect_socket(struct nlmon_nl_manager *mgr, int protocol)
 {
-	if (!mgr)
-		return -EINVAL;
-	
 	switch (protocol) {
 	case NETLINK_ROUTE:
 		return reconnect_route_socket(mgr);
-	
+		
 	case NETLINK_GENERIC:
 		return reconnect_genl_socket(mgr);
-	
+		
 	case NETLINK_SOCK_DIAG:
 		return reconnect_diag_socket(mgr);
-	
+		
 	case NETLINK_NETFILTER:
 		return reconnect_nf_socket(mgr);
-	
+		
 	default:
 		nlmon_nl_log_error("Unknown protocol for reconnection", EINVAL);
 		return -EINVAL;
 	}
 }
 
+/**
+ * Reconnect a netlink socket after connection loss
+ */
+int nlmon_nl_reconnect(struct nlmon_nl_manager *mgr, int protocol)
+{
+	int self_fd;
+	int ret;
+	
+	if (!mgr)
+		return -EINVAL;
+	
+	if (mgr->netns_fd < 0) {
+		ret = reconnect_socket(mgr, protocol);
+		goto out;
+	}
+	
+	/* Sockets bind to the namespace of the thread creating them */
+	self_fd = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+	if (self_fd < 0)
+		return -errno;
+	if (setns(mgr->netns_fd, CLONE_NEWNET) < 0) {
+		ret = -errno;
+		close(self_fd);
+		return ret;
+	}
+	
+	ret = reconnect_socket(mgr, protocol);
+	
+	if (setns(self_fd, CLONE_NEWNET) < 0)
+		nlmon_nl_log_error("Failed to return to own network namespace", errno);
+	close(self_fd);
+out:
+	if (ret == 0) {
+		mgr->reconnects++;
+		nlmon_nl_recv_rebind(mgr, protocol);
+	}
+	return ret;
+}
+
 /**
  * Check if a netlink socket is still connected
  */
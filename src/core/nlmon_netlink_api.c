@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include "nlmon_netlink_api.h"
 #include "nlmon_netlink_compat.h"
@@ -90,6 +91,24 @@ void nlmon_netlink_set_callback(struct nlmon_multi_protocol_ctx *ctx,
 	}
 }
 
+/**
+ * Set event handler taking events in the new format
+ */
+int nlmon_netlink_set_event_handler(struct nlmon_multi_protocol_ctx *ctx,
+                                    void (*handler)(struct nlmon_event *, void *),
+                                    void *user_data,
+                                    int use_libnl)
+{
+	if (!ctx)
+		return -EINVAL;
+	
+	if (!use_libnl)
+		return -ENOTSUP;
+	
+	nlmon_multi_protocol_set_event_handler_compat(ctx, handler, user_data);
+	return 0;
+}
+
 /**
  * Get file descriptor for event loop
  */
@@ -10,6 +10,8 @@
 #include <linux/rtnetlink.h>
 
 #include "event_processor.h"
+#include "nlmon_clock.h"
+#include "window_counter.h"
 #include "nlmon_nl_event.h"
 #include "nlmon_nl_route.h"
 #include "nlmon_nl_genl.h"
@@ -48,6 +50,14 @@ struct nlmon_multi_protocol_ctx *nlmon_multi_protocol_init_compat(void)
 		return NULL;
 	}
 	
+	compat_ctx->conversion_window = window_counter_create(NLMON_COMPAT_RATE_WINDOW);
+	if (!compat_ctx->conversion_window) {
+		fprintf(stderr, "Failed to allocate compatibility statistics\n");
+		nlmon_nl_manager_destroy(compat_ctx->nl_mgr);
+		free(compat_ctx);
+		return NULL;
+	}
+	
 	/* Initialize state */
 	compat_ctx->event_callback = NULL;
 	compat_ctx->user_data = NULL;
@@ -178,6 +188,19 @@ int nlmon_multi_protocol_disable_compat(struct nlmon_multi_protocol_ctx *ctx,
 	return 0;
 }
 
+/*
+ * Route manager events through the translator again after a native
+ * handler had them.
+ */
+static void compat_install_translator(struct nlmon_multi_protocol_ctx_compat *compat_ctx)
+{
+	if (!compat_ctx->event_handler || !compat_ctx->nl_mgr)
+		return;
+	
+	compat_ctx->event_handler = NULL;
+	nlmon_nl_set_callback(compat_ctx->nl_mgr, nlmon_compat_event_translator, compat_ctx);
+}
+
 /**
  * Set event callback (compatibility wrapper)
  */
@@ -194,10 +217,87 @@ void nlmon_multi_protocol_set_callback_compat(struct nlmon_multi_protocol_ctx *c
 	
 	/* Store old-style callback and user data */
 	compat_ctx->event_callback = callback;
+	compat_ctx->view_callback = NULL;
+	compat_ctx->user_data = user_data;
+	
+	compat_install_translator(compat_ctx);
+}
+
+/**
+ * Set view callback (compatibility wrapper)
+ */
+void nlmon_multi_protocol_set_view_callback_compat(struct nlmon_multi_protocol_ctx *ctx,
+                                                   void (*callback)(nlmon_event_type_t,
+                                                                    struct nlmon_compat_view *,
+                                                                    void *),
+                                                   void *user_data)
+{
+	struct nlmon_multi_protocol_ctx_compat *compat_ctx;
+	
+	if (!ctx)
+		return;
+	
+	compat_ctx = (struct nlmon_multi_protocol_ctx_compat *)ctx;
+	
+	compat_ctx->view_callback = callback;
+	compat_ctx->event_callback = NULL;
+	compat_ctx->user_data = user_data;
+	
+	compat_install_translator(compat_ctx);
+}
+
+/**
+ * Set native event handler, bypassing the translator
+ */
+void nlmon_multi_protocol_set_event_handler_compat(struct nlmon_multi_protocol_ctx *ctx,
+                                                   void (*handler)(struct nlmon_event *, void *),
+                                                   void *user_data)
+{
+	struct nlmon_multi_protocol_ctx_compat *compat_ctx;
+	
+	if (!ctx)
+		return;
+	
+	compat_ctx = (struct nlmon_multi_protocol_ctx_compat *)ctx;
+	
+	if (!handler) {
+		compat_ctx->event_handler = NULL;
+		compat_install_translator(compat_ctx);
+		return;
+	}
+	
+	compat_ctx->event_callback = NULL;
+	compat_ctx->view_callback = NULL;
 	compat_ctx->user_data = user_data;
+	compat_ctx->event_handler = handler;
+	
+	/* Events go straight from the manager to the handler */
+	if (compat_ctx->nl_mgr)
+		nlmon_nl_set_callback(compat_ctx->nl_mgr, handler, user_data);
+}
+
+/**
+ * Get compatibility layer statistics
+ */
+void nlmon_compat_get_stats(struct nlmon_multi_protocol_ctx *ctx, struct nlmon_compat_stats *stats)
+{
+	struct nlmon_multi_protocol_ctx_compat *compat_ctx;
+	
+	if (!stats)
+		return;
+	
+	memset(stats, 0, sizeof(*stats));
+	if (!ctx)
+		return;
 	
-	/* The event translator callback is already set up in init,
-	 * it will use these stored values */
+	compat_ctx = (struct nlmon_multi_protocol_ctx_compat *)ctx;
+	
+	stats->legacy_events = compat_ctx->legacy_events;
+	stats->conversions = compat_ctx->conversions;
+	stats->conversions_per_sec =
+		(double)window_counter_count(compat_ctx->conversion_window, nlmon_clock_seconds()) /
+		NLMON_COMPAT_RATE_WINDOW;
+	stats->native = compat_ctx->event_handler != NULL;
 }
 
 /**
@@ -298,124 +398,200 @@ void nlmon_multi_protocol_destroy_compat(struct nlmon_multi_protocol_ctx *ctx)
 		compat_ctx->nl_mgr = NULL;
 	}
 	
+	window_counter_destroy(compat_ctx->conversion_window);
+	
 	/* Free compatibility context */
 	free(compat_ctx);
 }
 
+/* Legacy structures of a view, in nlmon_compat_view.built */
+#define COMPAT_VIEW_GENERIC  (1u << 0)
+#define COMPAT_VIEW_DIAG     (1u << 1)
+
+static void compat_count_conversion(struct nlmon_multi_protocol_ctx_compat *compat_ctx)
+{
+	compat_ctx->conversions++;
+	window_counter_add(compat_ctx->conversion_window, nlmon_clock_seconds(), 1);
+}
+
 /**
- * Helper function to convert new event format to old format
- * 
- * This is the bridge between the new libnl-based event system and
- * the old callback-based system. It translates nlmon_event structures
- * to the old format and invokes the old-style callback.
+ * Raw netlink message of a view
  */
-void nlmon_compat_event_translator(struct nlmon_event *evt, void *user_data)
+struct nlmsghdr *nlmon_compat_view_nlmsg(struct nlmon_compat_view *view)
 {
-	struct nlmon_multi_protocol_ctx_compat *compat_ctx;
-	nlmon_event_type_t old_event_type;
-	void *old_event_data;
-	struct nlmon_generic_msg generic_msg;
-	struct nlmon_sock_diag diag_msg;
+	if (!view)
+		return NULL;
 	
-	if (!evt || !user_data)
-		return;
+	return view->evt->raw_msg;
+}
+
+/**
+ * Legacy generic netlink structure of a view
+ */
+const struct nlmon_generic_msg *nlmon_compat_view_generic(struct nlmon_compat_view *view)
+{
+	struct nlmon_event *evt;
 	
-	compat_ctx = (struct nlmon_multi_protocol_ctx_compat *)user_data;
+	if (!view || view->type != NLMON_EVENT_GENERIC)
+		return NULL;
 	
-	/* If no callback is set, nothing to do */
-	if (!compat_ctx->event_callback)
-		return;
+	if (view->built & COMPAT_VIEW_GENERIC)
+		return &view->generic;
+	
+	evt = view->evt;
+	view->generic.cmd = evt->netlink.genl_cmd;
+	view->generic.version = evt->netlink.genl_version;
+	view->generic.family_id = evt->netlink.genl_family_id;
+	strncpy(view->generic.family_name, evt->netlink.genl_family_name,
+	        sizeof(view->generic.family_name) - 1);
+	view->generic.family_name[sizeof(view->generic.family_name) - 1] = '\0';
+	
+	view->built |= COMPAT_VIEW_GENERIC;
+	compat_count_conversion(view->ctx);
+	return &view->generic;
+}
+
+/**
+ * Legacy socket diagnostics structure of a view
+ */
+const struct nlmon_sock_diag *nlmon_compat_view_sock_diag(struct nlmon_compat_view *view)
+{
+	struct nlmon_diag_info *diag;
+	
+	if (!view || view->type != NLMON_EVENT_SOCK_DIAG || !view->evt->netlink.data.diag)
+		return NULL;
 	
-	/* Translate event type and data based on netlink protocol */
+	if (view->built & COMPAT_VIEW_DIAG)
+		return &view->diag;
+	
+	diag = view->evt->netlink.data.diag;
+	view->diag.family = diag->family;
+	view->diag.state = diag->state;
+	view->diag.protocol = diag->protocol;
+	view->diag.src_port = diag->src_port;
+	view->diag.dst_port = diag->dst_port;
+	view->diag.inode = diag->inode;
+	strncpy(view->diag.src_addr, diag->src_addr, sizeof(view->diag.src_addr) - 1);
+	view->diag.src_addr[sizeof(view->diag.src_addr) - 1] = '\0';
+	strncpy(view->diag.dst_addr, diag->dst_addr, sizeof(view->diag.dst_addr) - 1);
+	view->diag.dst_addr[sizeof(view->diag.dst_addr) - 1] = '\0';
+	
+	view->built |= COMPAT_VIEW_DIAG;
+	compat_count_conversion(view->ctx);
+	return &view->diag;
+}
+
+/*
+ * Map an event to its old event type. Returns -1 for events the old API
+ * never reported.
+ */
+static int compat_event_type(const struct nlmon_event *evt, nlmon_event_type_t *type)
+{
 	switch (evt->netlink.protocol) {
 	case NETLINK_ROUTE:
-		/* Determine old event type from message type */
 		switch (evt->netlink.msg_type) {
 		case RTM_NEWLINK:
 		case RTM_DELLINK:
 		case RTM_GETLINK:
 		case RTM_SETLINK:
-			old_event_type = NLMON_EVENT_LINK;
-			break;
+			*type = NLMON_EVENT_LINK;
+			return 0;
 			
 		case RTM_NEWADDR:
 		case RTM_DELADDR:
 		case RTM_GETADDR:
-			old_event_type = NLMON_EVENT_ADDR;
-			break;
+			*type = NLMON_EVENT_ADDR;
+			return 0;
 			
 		case RTM_NEWROUTE:
 		case RTM_DELROUTE:
 		case RTM_GETROUTE:
-			old_event_type = NLMON_EVENT_ROUTE;
-			break;
+			*type = NLMON_EVENT_ROUTE;
+			return 0;
 			
 		case RTM_NEWNEIGH:
 		case RTM_DELNEIGH:
 		case RTM_GETNEIGH:
-			old_event_type = NLMON_EVENT_NEIGH;
-			break;
+			*type = NLMON_EVENT_NEIGH;
+			return 0;
 			
 		case RTM_NEWRULE:
 		case RTM_DELRULE:
 		case RTM_GETRULE:
-			old_event_type = NLMON_EVENT_RULE;
-			break;
+			*type = NLMON_EVENT_RULE;
+			return 0;
 			
 		default:
-			/* Unknown route message type, skip */
-			return;
+			return -1;
 		}
 		
-		/* For route protocol, pass the raw netlink header */
-		old_event_data = evt->raw_msg;
-		break;
-		
 	case NETLINK_GENERIC:
-		old_event_type = NLMON_EVENT_GENERIC;
+		*type = NLMON_EVENT_GENERIC;
+		return 0;
 		
-		/* Convert to old generic message format */
-		generic_msg.cmd = evt->netlink.genl_cmd;
-		generic_msg.version = evt->netlink.genl_version;
-		generic_msg.family_id = evt->netlink.genl_family_id;
-		strncpy(generic_msg.family_name, evt->netlink.genl_family_name,
-		        sizeof(generic_msg.family_name) - 1);
-		generic_msg.family_name[sizeof(generic_msg.family_name) - 1] = '\0';
+	case NETLINK_SOCK_DIAG:
+		/* Nothing to report without socket data */
+		if (!evt->netlink.data.diag)
+			return -1;
+		*type = NLMON_EVENT_SOCK_DIAG;
+		return 0;
 		
-		old_event_data = &generic_msg;
+	default:
+		return -1;
+	}
+}
+
+/**
+ * Helper function to convert new event format to old format
+ * 
+ * This is the bridge between the new libnl-based event system and
+ * the old callback-based system. View callbacks get the event as is and
+ * convert what they read; plain callbacks get the old structures built
+ * up front.
+ */
+void nlmon_compat_event_translator(struct nlmon_event *evt, void *user_data)
+{
+	struct nlmon_multi_protocol_ctx_compat *compat_ctx;
+	struct nlmon_compat_view view;
+	void *old_event_data;
+	
+	if (!evt || !user_data)
+		return;
+	
+	compat_ctx = (struct nlmon_multi_protocol_ctx_compat *)user_data;
+	
+	/* If no callback is set, nothing to do */
+	if (!compat_ctx->event_callback && !compat_ctx->view_callback)
+		return;
+	
+	if (compat_event_type(evt, &view.type) < 0)
+		return;
+	
+	view.evt = evt;
+	view.ctx = compat_ctx;
+	view.built = 0;
+	compat_ctx->legacy_events++;
+	
+	if (compat_ctx->view_callback) {
+		compat_ctx->view_callback(view.type, &view, compat_ctx->user_data);
+		return;
+	}
+	
+	switch (view.type) {
+	case NLMON_EVENT_GENERIC:
+		old_event_data = (void *)nlmon_compat_view_generic(&view);
 		break;
 		
-	case NETLINK_SOCK_DIAG:
-		old_event_type = NLMON_EVENT_SOCK_DIAG;
-		
-		/* Convert to old socket diag format */
-		if (evt->netlink.data.diag) {
-			diag_msg.family = evt->netlink.data.diag->family;
-			diag_msg.state = evt->netlink.data.diag->state;
-			diag_msg.protocol = evt->netlink.data.diag->protocol;
-			diag_msg.src_port = evt->netlink.data.diag->src_port;
-			diag_msg.dst_port = evt->netlink.data.diag->dst_port;
-			diag_msg.inode = evt->netlink.data.diag->inode;
-			strncpy(diag_msg.src_addr, evt->netlink.data.diag->src_addr,
-			        sizeof(diag_msg.src_addr) - 1);
-			diag_msg.src_addr[sizeof(diag_msg.src_addr) - 1] = '\0';
-			strncpy(diag_msg.dst_addr, evt->netlink.data.diag->dst_addr,
-			        sizeof(diag_msg.dst_addr) - 1);
-			diag_msg.dst_addr[sizeof(diag_msg.dst_addr) - 1] = '\0';
-			
-			old_event_data = &diag_msg;
-		} else {
-			/* No diag data available, skip */
-			return;
-		}
+	case NLMON_EVENT_SOCK_DIAG:
+		old_event_data = (void *)nlmon_compat_view_sock_diag(&view);
 		break;
 		
 	default:
-		/* Unknown protocol, skip */
-		return;
+		/* For route protocol, pass the raw netlink header */
+		old_event_data = evt->raw_msg;
+		break;
 	}
 	
 	/* Invoke old-style callback */
-	compat_ctx->event_callback(old_event_type, old_event_data,
-	                           compat_ctx->user_data);
+	compat_ctx->event_callback(view.type, old_event_data, compat_ctx->user_data);
 }
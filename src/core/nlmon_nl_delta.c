@@ -0,0 +1,363 @@
+/* nlmon_nl_delta.c - Suppression of NETLINK_ROUTE updates that change nothing
+ *
+ * Objects are kept in an id_table keyed by the seeded hash of their
+ * identity, each with the digest of its chosen fields. The digest hash is
+ * seeded with the identity hash and covers the field mask, so an identity
+ * collision or a change of the mask shows as a changed object and lets the
+ * update through rather than dropping it.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "nlmon_netlink.h"
+#include "nlmon_nl_delta.h"
+#include "nlmon_nl_route.h"
+#include "event_processor.h"
+#include "id_table.h"
+#include "sketch.h"
+#include "nlmon_clock.h"
+
+/* Object identity, zero-filled so it can be hashed bytewise */
+struct delta_identity {
+	uint64_t netns;
+	uint8_t kind;
+	uint8_t family;
+	uint8_t prefixlen;
+	uint8_t tos;
+	int32_t ifindex;
+	uint32_t priority;
+	uint32_t table;
+	char addr[64];
+};
+
+/* Fields of an object that count, zero-filled and masked */
+struct delta_fields {
+	uint32_t mask;
+	uint32_t flags;
+	uint32_t mtu;
+	int32_t state;
+	int32_t oif;
+	uint8_t scope;
+	uint8_t protocol;
+	uint8_t type;
+	uint8_t lladdr[6];
+	char name[32];
+	char addr[64];
+};
+
+struct delta_entry {
+	struct id_slot slot;
+	uint64_t digest;
+	time_t last_passed;
+};
+
+struct nlmon_nl_delta {
+	pthread_mutex_t lock;
+	struct id_table objects;
+	size_t max_objects;
+	uint32_t fields[NLMON_NL_DELTA_KIND_COUNT];
+	unsigned int heartbeat;          /* Seconds, 0 to drop every repeat */
+	uint64_t seed;
+	struct nlmon_nl_delta_kind_stats stats[NLMON_NL_DELTA_KIND_COUNT];
+};
+
+/* Copy a parsed string, keeping only its terminated part */
+static void copy_str(char *dst, size_t size, const char *src, size_t src_size)
+{
+	size_t len = strnlen(src, src_size < size ? src_size : size - 1);
+	
+	memcpy(dst, src, len);
+	memset(dst + len, 0, size - len);
+}
+
+static int delta_kind_of(uint16_t msg_type, int *is_del)
+{
+	switch (msg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		*is_del = msg_type == RTM_DELLINK;
+		return NLMON_NL_DELTA_LINK;
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		*is_del = msg_type == RTM_DELADDR;
+		return NLMON_NL_DELTA_ADDR;
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE:
+		*is_del = msg_type == RTM_DELROUTE;
+		return NLMON_NL_DELTA_ROUTE;
+	case RTM_NEWNEIGH:
+	case RTM_DELNEIGH:
+		*is_del = msg_type == RTM_DELNEIGH;
+		return NLMON_NL_DELTA_NEIGH;
+	default:
+		return -1;
+	}
+}
+
+/* Identity and masked fields of an event's object */
+static void delta_describe(const struct nlmon_event *evt, int kind, uint32_t mask,
+                           struct delta_identity *id, struct delta_fields *f)
+{
+	const struct nlmon_link_info *link;
+	const struct nlmon_addr_info *addr;
+	const struct nlmon_route_info *route;
+	const struct nlmon_neigh_info *neigh;
+	
+	memset(id, 0, sizeof(*id));
+	memset(f, 0, sizeof(*f));
+	id->netns = evt->netlink.netns;
+	id->kind = (uint8_t)kind;
+	f->mask = mask;
+	
+	switch (kind) {
+	case NLMON_NL_DELTA_LINK:
+		link = evt->netlink.data.link;
+		id->ifindex = link->ifindex;
+		if (mask & NLMON_NL_DELTA_LINK_IFNAME)
+			copy_str(f->name, sizeof(f->name), link->ifname, sizeof(link->ifname));
+		if (mask & NLMON_NL_DELTA_LINK_FLAGS)
+			f->flags = link->flags;
+		if (mask & NLMON_NL_DELTA_LINK_MTU)
+			f->mtu = link->mtu;
+		if (mask & NLMON_NL_DELTA_LINK_ADDRESS)
+			memcpy(f->lladdr, link->addr, sizeof(f->lladdr));
+		if (mask & NLMON_NL_DELTA_LINK_QDISC)
+			copy_str(f->addr, sizeof(f->addr), link->qdisc, sizeof(link->qdisc));
+		if (mask & NLMON_NL_DELTA_LINK_OPERSTATE)
+			f->state = link->operstate;
+		break;
+	case NLMON_NL_DELTA_ADDR:
+		addr = evt->netlink.data.addr;
+		id->family = (uint8_t)addr->family;
+		id->ifindex = addr->ifindex;
+		id->prefixlen = addr->prefixlen;
+		copy_str(id->addr, sizeof(id->addr), addr->addr, sizeof(addr->addr));
+		if (mask & NLMON_NL_DELTA_ADDR_SCOPE)
+			f->scope = addr->scope;
+		if (mask & NLMON_NL_DELTA_ADDR_LABEL)
+			copy_str(f->name, sizeof(f->name), addr->label, sizeof(addr->label));
+		break;
+	case NLMON_NL_DELTA_ROUTE:
+		route = evt->netlink.data.route;
+		id->family = (uint8_t)route->family;
+		id->prefixlen = route->dst_len;
+		id->tos = route->tos;
+		id->priority = route->priority;
+		id->table = route->table;
+		copy_str(id->addr, sizeof(id->addr), route->dst, sizeof(route->dst));
+		if (mask & NLMON_NL_DELTA_ROUTE_GATEWAY)
+			copy_str(f->addr, sizeof(f->addr), route->gateway, sizeof(route->gateway));
+		if (mask & NLMON_NL_DELTA_ROUTE_OIF)
+			f->oif = route->oif;
+		if (mask & NLMON_NL_DELTA_ROUTE_SRC)
+			copy_str(f->name, sizeof(f->name), route->src, sizeof(route->src));
+		if (mask & NLMON_NL_DELTA_ROUTE_PROTOCOL)
+			f->protocol = route->protocol;
+		if (mask & NLMON_NL_DELTA_ROUTE_SCOPE)
+			f->scope = route->scope;
+		if (mask & NLMON_NL_DELTA_ROUTE_TYPE)
+			f->type = route->type;
+		break;
+	case NLMON_NL_DELTA_NEIGH:
+		neigh = evt->netlink.data.neigh;
+		id->family = (uint8_t)neigh->family;
+		id->ifindex = neigh->ifindex;
+		copy_str(id->addr, sizeof(id->addr), neigh->dst, sizeof(neigh->dst));
+		if (mask & NLMON_NL_DELTA_NEIGH_STATE)
+			f->state = neigh->state;
+		if (mask & NLMON_NL_DELTA_NEIGH_FLAGS)
+			f->flags = neigh->flags;
+		if (mask & NLMON_NL_DELTA_NEIGH_LLADDR)
+			memcpy(f->lladdr, neigh->lladdr, sizeof(f->lladdr));
+		break;
+	}
+}
+
+/**
+ * Create a digest table
+ */
+struct nlmon_nl_delta *nlmon_nl_delta_create(size_t max_objects)
+{
+	struct id_table objects = ID_TABLE_INIT(struct delta_entry);
+	struct nlmon_nl_delta *delta;
+	int i;
+	
+	delta = calloc(1, sizeof(*delta));
+	if (!delta)
+		return NULL;
+	
+	if (pthread_mutex_init(&delta->lock, NULL) != 0) {
+		free(delta);
+		return NULL;
+	}
+	
+	delta->objects = objects;
+	delta->max_objects = max_objects ? max_objects : NLMON_NL_DELTA_DEFAULT_OBJECTS;
+	for (i = 0; i < NLMON_NL_DELTA_KIND_COUNT; i++)
+		delta->fields[i] = NLMON_NL_DELTA_ALL_FIELDS;
+	
+	/* Identities come from the network, so do not let them pick their slots */
+	delta->seed = nlmon_clock_precise_ns() ^ ((uint64_t)(uintptr_t)delta << 16);
+	
+	return delta;
+}
+
+/**
+ * Destroy a digest table
+ */
+void nlmon_nl_delta_destroy(struct nlmon_nl_delta *delta)
+{
+	if (!delta)
+		return;
+	
+	id_table_free(&delta->objects);
+	pthread_mutex_destroy(&delta->lock);
+	free(delta);
+}
+
+/**
+ * Choose the fields whose change lets an update through
+ */
+int nlmon_nl_delta_set_fields(struct nlmon_nl_delta *delta,
+                              enum nlmon_nl_delta_kind kind, uint32_t fields)
+{
+	if (!delta || (int)kind < 0 || kind >= NLMON_NL_DELTA_KIND_COUNT)
+		return -EINVAL;
+	
+	pthread_mutex_lock(&delta->lock);
+	delta->fields[kind] = fields;
+	pthread_mutex_unlock(&delta->lock);
+	
+	return 0;
+}
+
+/**
+ * Let an unchanged object through now and then
+ */
+void nlmon_nl_delta_set_heartbeat(struct nlmon_nl_delta *delta, unsigned int seconds)
+{
+	if (!delta)
+		return;
+	
+	pthread_mutex_lock(&delta->lock);
+	delta->heartbeat = seconds;
+	pthread_mutex_unlock(&delta->lock);
+}
+
+/**
+ * Compare an event against the last digest of its object
+ */
+int nlmon_nl_delta_check(struct nlmon_nl_delta *delta, struct nlmon_event *evt)
+{
+	struct delta_identity id;
+	struct delta_fields fields;
+	struct delta_entry *entry;
+	uint64_t key, digest;
+	time_t now;
+	int kind, is_del = 0;
+	int created;
+	int pass = 1;
+	
+	if (!delta || !evt || evt->netlink.protocol != NETLINK_ROUTE)
+		return 1;
+	
+	kind = delta_kind_of(evt->netlink.msg_type, &is_del);
+	if (kind < 0)
+		return 1;
+	
+	nlmon_event_materialize(evt);
+	if (!evt->netlink.data.generic)
+		return 1;
+	
+	pthread_mutex_lock(&delta->lock);
+	
+	/* No fields that count, every update passes */
+	if (!delta->fields[kind] && !is_del) {
+		delta->stats[kind].changed++;
+		pthread_mutex_unlock(&delta->lock);
+		return 1;
+	}
+	
+	delta_describe(evt, kind, delta->fields[kind], &id, &fields);
+	key = sketch_hash(&id, sizeof(id), delta->seed);
+	
+	if (is_del) {
+		entry = id_table_find(&delta->objects, key);
+		if (entry)
+			id_table_remove(&delta->objects, entry);
+		delta->stats[kind].changed++;
+		pthread_mutex_unlock(&delta->lock);
+		return 1;
+	}
+	
+	digest = sketch_hash(&fields, sizeof(fields), key);
+	now = nlmon_clock_seconds();
+	
+	entry = id_table_find(&delta->objects, key);
+	if (!entry) {
+		if (delta->objects.used >= delta->max_objects) {
+			delta->stats[kind].untracked++;
+			pthread_mutex_unlock(&delta->lock);
+			return 1;
+		}
+		entry = id_table_get(&delta->objects, key, &created);
+		if (!entry) {
+			delta->stats[kind].untracked++;
+			pthread_mutex_unlock(&delta->lock);
+			return 1;
+		}
+		entry->digest = digest;
+		entry->last_passed = now;
+		delta->stats[kind].changed++;
+	} else if (entry->digest != digest) {
+		entry->digest = digest;
+		entry->last_passed = now;
+		delta->stats[kind].changed++;
+	} else if (delta->heartbeat && now - entry->last_passed >= (time_t)delta->heartbeat) {
+		entry->last_passed = now;
+		delta->stats[kind].heartbeats_passed++;
+	} else {
+		delta->stats[kind].heartbeats++;
+		pass = 0;
+	}
+	
+	pthread_mutex_unlock(&delta->lock);
+	
+	return pass;
+}
+
+/**
+ * Forget every object
+ */
+void nlmon_nl_delta_clear(struct nlmon_nl_delta *delta)
+{
+	if (!delta)
+		return;
+	
+	pthread_mutex_lock(&delta->lock);
+	id_table_free(&delta->objects);
+	pthread_mutex_unlock(&delta->lock);
+}
+
+/**
+ * Get delta statistics
+ */
+void nlmon_nl_delta_get_stats(struct nlmon_nl_delta *delta, struct nlmon_nl_delta_stats *stats)
+{
+	if (!delta || !stats)
+		return;
+	
+	pthread_mutex_lock(&delta->lock);
+	memcpy(stats->kinds, delta->stats, sizeof(stats->kinds));
+	stats->objects = delta->objects.used;
+	pthread_mutex_unlock(&delta->lock);
+}
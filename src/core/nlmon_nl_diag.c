@@ -20,6 +20,7 @@
 
 #include "nlmon_netlink.h"
 #include "nlmon_nl_diag.h"
+#include "nlmon_nl_dispatch.h"
 #include "event_processor.h"
 
 /**
@@ -32,6 +33,7 @@ int nlmon_diag_msg_handler(struct nl_msg *msg, void *arg)
 {
 	struct nlmon_nl_manager *mgr = (struct nlmon_nl_manager *)arg;
 	struct nlmsghdr *nlh = nlmsg_hdr(msg);
+	const struct nlmon_nl_msg_desc *desc;
 	struct nlmon_event evt;
 	int ret = 0;
 	
@@ -40,35 +42,32 @@ int nlmon_diag_msg_handler(struct nl_msg *msg, void *arg)
 	
 	/* Initialize event structure */
 	memset(&evt, 0, sizeof(evt));
-	evt.timestamp = time(NULL) * 1000000000ULL; /* Convert to nanoseconds */
+	evt.timestamp = nlmon_nl_recv_timestamp();
 	evt.netlink.protocol = NETLINK_SOCK_DIAG;
 	evt.netlink.msg_type = nlh->nlmsg_type;
 	evt.netlink.msg_flags = nlh->nlmsg_flags;
 	evt.netlink.seq = nlh->nlmsg_seq;
 	evt.netlink.pid = nlh->nlmsg_pid;
 	
-	/* Route to appropriate parser based on message type */
-	switch (nlh->nlmsg_type) {
-	case SOCK_DIAG_BY_FAMILY:
-		/* This is a response to a diagnostic request */
-		ret = nlmon_parse_inet_diag_msg(nlh, &evt);
-		evt.event_type = nlh->nlmsg_type;
-		break;
-		
-	case NLMSG_DONE:
+	if (nlh->nlmsg_type == NLMSG_DONE) {
 		/* End of multipart message */
 		return NL_STOP;
-		
-	case NLMSG_ERROR:
+	}
+	
+	if (nlh->nlmsg_type == NLMSG_ERROR) {
 		/* Error message */
 		fprintf(stderr, "Received NLMSG_ERROR in diag handler\n");
 		return NL_STOP;
-		
-	default:
-		/* Unknown or unhandled message type */
-		return NL_SKIP;
 	}
 	
+	/* Responses to diagnostic requests, nothing else is handled */
+	desc = nlmon_nl_msg_lookup(NETLINK_SOCK_DIAG, nlh->nlmsg_type);
+	if (!desc || !(desc->subscribers & NLMON_NL_SUB_EVENTS))
+		return NL_SKIP;
+	
+	ret = desc->parse(nlh, &evt);
+	evt.event_type = nlh->nlmsg_type;
+	
 	/* If parsing failed, skip this message */
 	if (ret < 0) {
 		fprintf(stderr, "Failed to parse diag message type %d: %d\n",
@@ -77,9 +76,7 @@ int nlmon_diag_msg_handler(struct nl_msg *msg, void *arg)
 	}
 	
 	/* Forward event to nlmon event processor if callback is set */
-	if (mgr->event_callback) {
-		mgr->event_callback(&evt, mgr->user_data);
-	}
+	nlmon_nl_deliver_event(mgr, &evt);
 	
 	/* Free any allocated data in the event */
 	if (evt.netlink.data.generic) {
@@ -0,0 +1,779 @@
+/* nlmon_nl_diag_dump.c - Kernel-filtered, incremental socket diagnostics dumps
+ *
+ * Each family and protocol the filters cover gets one SOCK_DIAG_BY_FAMILY
+ * request carrying the compiled bytecode. Sockets live in an id_table
+ * keyed by the seeded hash of their binary identity and stamped with the
+ * generation of the last dump that saw them, so the sweep after a dump
+ * finds the vanished ones the way the NETLINK_ROUTE resync does.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+
+#include <netlink/netlink.h>
+#include <netlink/socket.h>
+#include <netlink/msg.h>
+#include <netlink/attr.h>
+#include <netlink/handlers.h>
+
+#include "nlmon_netlink.h"
+#include "nlmon_nl_diag.h"
+#include "nlmon_nl_diag_dump.h"
+#include "nlmon_nl_error.h"
+#include "event_processor.h"
+#include "id_table.h"
+#include "sketch.h"
+#include "nlmon_clock.h"
+
+#define DUMP_SOCK_RCVBUF       (4 * 1024 * 1024)
+#define DUMP_TIMEOUT_SEC       2         /* Per-receive dump timeout */
+#define DUMP_MAX_REQUESTS      4         /* TCP and UDP over IPv4 and IPv6 */
+#define DUMP_CHURN_PERCENT     1         /* Changes that shrink the interval */
+
+/* Socket identity, zero-filled so it can be hashed and compared bytewise */
+struct diag_identity {
+	uint8_t family;
+	uint8_t protocol;
+	uint16_t sport;                  /* Network order, as dumped */
+	uint16_t dport;
+	uint16_t pad;
+	uint32_t inode;
+	uint32_t ifindex;
+	uint32_t src[4];
+	uint32_t dst[4];
+};
+
+struct socket_entry {
+	struct id_slot slot;
+	struct diag_identity id;
+	uint64_t generation;             /* Last dump that saw the socket */
+	uint32_t uid;
+	uint8_t state;
+};
+
+/* One SOCK_DIAG_BY_FAMILY request of a dump */
+struct dump_request {
+	uint8_t family;
+	uint8_t protocol;
+	uint32_t states;
+	int bytecode_len;
+	uint8_t bytecode[NLMON_DIAG_DUMP_BYTECODE_MAX];
+};
+
+struct nlmon_diag_dump {
+	struct nlmon_diag_dump_config config;
+	struct nlmon_diag_filter filters[NLMON_DIAG_DUMP_MAX_FILTERS];
+	struct dump_request requests[DUMP_MAX_REQUESTS];
+	size_t request_count;
+	
+	struct id_table sockets;
+	uint64_t seed;
+	uint64_t generation;
+	
+	unsigned int interval;
+	time_t last_dump;                /* 0 before the first dump */
+	struct nlmon_diag_dump_stats stats;
+};
+
+/* Receive context of one request */
+struct dump_ctx {
+	struct nlmon_diag_dump *dump;
+	const struct dump_request *request;
+	nlmon_diag_dump_cb cb;
+	void *cb_ctx;
+	int emit;                        /* 0 while recording a silent baseline */
+	int done;
+	int events;
+	int new_sockets;
+	int changed_sockets;
+};
+
+static uint8_t filter_protocol(const struct nlmon_diag_filter *f)
+{
+	return f->protocol ? f->protocol : IPPROTO_TCP;
+}
+
+/* Family a prefix is written in, AF_UNSPEC for none */
+static int prefix_family(const char *prefix)
+{
+	if (!prefix[0])
+		return AF_UNSPEC;
+	return strchr(prefix, ':') ? AF_INET6 : AF_INET;
+}
+
+/* Family a filter is limited to, -EINVAL if its parts disagree */
+static int filter_family(const struct nlmon_diag_filter *f)
+{
+	int family = f->family;
+	int src = prefix_family(f->src);
+	int dst = prefix_family(f->dst);
+	
+	if (src != AF_UNSPEC) {
+		if (family != AF_UNSPEC && family != src)
+			return -EINVAL;
+		family = src;
+	}
+	if (dst != AF_UNSPEC) {
+		if (family != AF_UNSPEC && family != dst)
+			return -EINVAL;
+		family = dst;
+	}
+	return family;
+}
+
+static int filter_applies(const struct nlmon_diag_filter *f, int family, int protocol)
+{
+	int f_family = filter_family(f);
+	
+	return filter_protocol(f) == protocol &&
+	       (f_family == AF_UNSPEC || f_family == family);
+}
+
+static int filter_is_empty(const struct nlmon_diag_filter *f)
+{
+	return !f->sport_min && !f->sport_max && !f->dport_min && !f->dport_max &&
+	       !f->src[0] && !f->dst[0];
+}
+
+/* Bytecode being written */
+struct bc_writer {
+	uint8_t *buf;
+	size_t size;
+	size_t len;
+	int error;
+	
+	/* Ops whose false branch leads to the next filter, or past the end */
+	size_t fail_ops[NLMON_DIAG_DUMP_MAX_FILTERS * 6];
+	size_t fail_filter[NLMON_DIAG_DUMP_MAX_FILTERS * 6];
+	size_t fail_count;
+};
+
+static void *bc_reserve(struct bc_writer *w, size_t len)
+{
+	void *p;
+	
+	if (w->error)
+		return NULL;
+	if (w->len + len > w->size || w->len + len > UINT16_MAX) {
+		w->error = -ENOSPC;
+		return NULL;
+	}
+	
+	p = w->buf + w->len;
+	memset(p, 0, len);
+	w->len += len;
+	return p;
+}
+
+/* Port comparison, the port goes in the no field of a second op */
+static void bc_port(struct bc_writer *w, size_t filter, int code, uint16_t port)
+{
+	size_t pos = w->len;
+	struct inet_diag_bc_op *op = bc_reserve(w, 2 * sizeof(*op));
+	
+	if (!op)
+		return;
+	
+	op[0].code = code;
+	op[0].yes = 2 * sizeof(*op);
+	op[1].no = port;
+	w->fail_ops[w->fail_count] = pos;
+	w->fail_filter[w->fail_count++] = filter;
+}
+
+/* Address prefix comparison */
+static void bc_host(struct bc_writer *w, size_t filter, int code,
+                    const char *prefix, uint8_t prefix_len)
+{
+	struct inet_diag_bc_op *op;
+	struct inet_diag_hostcond *cond;
+	int family = prefix_family(prefix);
+	size_t addr_len = family == AF_INET6 ? 16 : 4;
+	size_t len = sizeof(*op) + sizeof(*cond) + addr_len;
+	size_t pos = w->len;
+	uint8_t addr[16];
+	
+	if (w->error)
+		return;
+	if (inet_pton(family, prefix, addr) != 1 || prefix_len > addr_len * 8) {
+		w->error = -EINVAL;
+		return;
+	}
+	
+	op = bc_reserve(w, len);
+	if (!op)
+		return;
+	
+	op->code = code;
+	op->yes = len;
+	cond = (struct inet_diag_hostcond *)(op + 1);
+	cond->family = family;
+	cond->prefix_len = prefix_len;
+	cond->port = -1;
+	memcpy(cond->addr, addr, addr_len);
+	w->fail_ops[w->fail_count] = pos;
+	w->fail_filter[w->fail_count++] = filter;
+}
+
+/**
+ * Compile filters into INET_DIAG_REQ_BYTECODE
+ *
+ * Filters are laid out one after another. A failed condition jumps to
+ * the start of the next filter, or past the end to reject the socket, and
+ * a filter whose conditions all held jumps to the end to accept it.
+ */
+int nlmon_diag_compile_filters(const struct nlmon_diag_filter *filters, size_t count,
+                               int family, int protocol, void *buf, size_t size)
+{
+	struct bc_writer *w;
+	size_t starts[NLMON_DIAG_DUMP_MAX_FILTERS + 1];
+	size_t jumps[NLMON_DIAG_DUMP_MAX_FILTERS];
+	size_t applied = 0, total, i;
+	int ret;
+	
+	if ((!filters && count) || count > NLMON_DIAG_DUMP_MAX_FILTERS || !buf)
+		return -EINVAL;
+	
+	for (i = 0; i < count; i++) {
+		if (filter_family(&filters[i]) < 0)
+			return -EINVAL;
+		if (!filter_applies(&filters[i], family, protocol))
+			continue;
+		if (filter_is_empty(&filters[i]))
+			return 0;
+		applied++;
+	}
+	if (!applied)
+		return -ENOENT;
+	total = applied;
+	
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return -ENOMEM;
+	w->buf = buf;
+	w->size = size;
+	
+	applied = 0;
+	for (i = 0; i < count; i++) {
+		const struct nlmon_diag_filter *f = &filters[i];
+		
+		if (!filter_applies(f, family, protocol))
+			continue;
+		
+		if ((f->sport_max && f->sport_min > f->sport_max) ||
+		    (f->dport_max && f->dport_min > f->dport_max)) {
+			w->error = -EINVAL;
+			break;
+		}
+		
+		starts[applied] = w->len;
+		if (f->sport_min)
+			bc_port(w, applied, INET_DIAG_BC_S_GE, f->sport_min);
+		if (f->sport_max)
+			bc_port(w, applied, INET_DIAG_BC_S_LE, f->sport_max);
+		if (f->dport_min)
+			bc_port(w, applied, INET_DIAG_BC_D_GE, f->dport_min);
+		if (f->dport_max)
+			bc_port(w, applied, INET_DIAG_BC_D_LE, f->dport_max);
+		if (f->src[0])
+			bc_host(w, applied, INET_DIAG_BC_S_COND, f->src, f->src_len);
+		if (f->dst[0])
+			bc_host(w, applied, INET_DIAG_BC_D_COND, f->dst, f->dst_len);
+		
+		/* Every filter but the last accepts with a jump to the end */
+		if (applied + 1 < total) {
+			jumps[applied] = w->len;
+			bc_reserve(w, sizeof(struct inet_diag_bc_op));
+		}
+		applied++;
+	}
+	
+	ret = w->error;
+	if (ret == 0) {
+		struct inet_diag_bc_op *op;
+		
+		starts[applied] = w->len + 4;
+		
+		for (i = 0; i < w->fail_count; i++) {
+			op = (struct inet_diag_bc_op *)(w->buf + w->fail_ops[i]);
+			op->no = starts[w->fail_filter[i] + 1] - w->fail_ops[i];
+		}
+		for (i = 0; i + 1 < applied; i++) {
+			op = (struct inet_diag_bc_op *)(w->buf + jumps[i]);
+			op->code = INET_DIAG_BC_JMP;
+			op->yes = sizeof(*op);
+			op->no = w->len - jumps[i];
+		}
+		ret = (int)w->len;
+	}
+	
+	free(w);
+	return ret;
+}
+
+/* Requests of a dump, one per family and protocol the filters cover */
+static int dump_plan(struct nlmon_diag_dump *dump)
+{
+	static const uint8_t families[] = { AF_INET, AF_INET6 };
+	static const uint8_t protocols[] = { IPPROTO_TCP, IPPROTO_UDP };
+	struct dump_request *req;
+	size_t i, j, k;
+	int len;
+	
+	dump->request_count = 0;
+	for (i = 0; i < sizeof(protocols); i++) {
+		for (j = 0; j < sizeof(families); j++) {
+			req = &dump->requests[dump->request_count];
+			memset(req, 0, sizeof(*req));
+			req->family = families[j];
+			req->protocol = protocols[i];
+			
+			if (!dump->config.filter_count) {
+				dump->request_count++;
+				continue;
+			}
+			
+			len = nlmon_diag_compile_filters(dump->filters, dump->config.filter_count,
+			                                 req->family, req->protocol,
+			                                 req->bytecode, sizeof(req->bytecode));
+			if (len == -ENOENT)
+				continue;
+			if (len < 0)
+				return len;
+			req->bytecode_len = len;
+			
+			/* The state mask is per request, so filters sharing one merge theirs */
+			for (k = 0; k < dump->config.filter_count; k++) {
+				const struct nlmon_diag_filter *f = &dump->filters[k];
+				
+				if (filter_applies(f, req->family, req->protocol))
+					req->states |= f->states ? f->states : ~0u;
+			}
+			dump->request_count++;
+		}
+	}
+	
+	return 0;
+}
+
+/**
+ * Create a dumper
+ */
+struct nlmon_diag_dump *nlmon_diag_dump_create(const struct nlmon_diag_dump_config *config)
+{
+	struct id_table sockets = ID_TABLE_INIT(struct socket_entry);
+	struct nlmon_diag_dump *dump;
+	
+	if (config && (config->filter_count > NLMON_DIAG_DUMP_MAX_FILTERS ||
+	               (config->filter_count && !config->filters)))
+		return NULL;
+	
+	dump = calloc(1, sizeof(*dump));
+	if (!dump)
+		return NULL;
+	
+	if (config) {
+		dump->config = *config;
+		if (config->filter_count)
+			memcpy(dump->filters, config->filters,
+			       config->filter_count * sizeof(*config->filters));
+	}
+	dump->config.filters = NULL;
+	if (!dump->config.max_sockets)
+		dump->config.max_sockets = NLMON_DIAG_DUMP_DEFAULT_SOCKETS;
+	if (!dump->config.min_interval)
+		dump->config.min_interval = NLMON_DIAG_DUMP_DEFAULT_MIN_INTERVAL;
+	if (!dump->config.max_interval)
+		dump->config.max_interval = NLMON_DIAG_DUMP_DEFAULT_MAX_INTERVAL;
+	if (dump->config.max_interval < dump->config.min_interval)
+		dump->config.max_interval = dump->config.min_interval;
+	
+	if (dump_plan(dump) < 0) {
+		free(dump);
+		return NULL;
+	}
+	
+	dump->sockets = sockets;
+	dump->interval = dump->config.min_interval;
+	
+	/* Identities come from the network, so do not let them pick their slots */
+	dump->seed = nlmon_clock_precise_ns() ^ ((uint64_t)(uintptr_t)dump << 16);
+	
+	return dump;
+}
+
+/**
+ * Destroy a dumper
+ */
+void nlmon_diag_dump_destroy(struct nlmon_diag_dump *dump)
+{
+	if (!dump)
+		return;
+	
+	id_table_free(&dump->sockets);
+	free(dump);
+}
+
+/* Report a dumped socket, @nlh only parsed when it is reported */
+static void dump_report(struct dump_ctx *ctx, struct nlmsghdr *nlh, uint8_t change)
+{
+	struct nlmon_diag_info *info;
+	struct nlmon_event evt;
+	
+	memset(&evt, 0, sizeof(evt));
+	evt.timestamp = nlmon_clock_realtime_ns();
+	evt.netlink.protocol = NETLINK_SOCK_DIAG;
+	evt.netlink.msg_type = SOCK_DIAG_BY_FAMILY;
+	evt.netlink.msg_flags = nlh->nlmsg_flags;
+	evt.netlink.seq = nlh->nlmsg_seq;
+	evt.netlink.pid = nlh->nlmsg_pid;
+	evt.event_type = SOCK_DIAG_BY_FAMILY;
+	
+	if (nlmon_parse_inet_diag_msg(nlh, &evt) < 0)
+		return;
+	
+	/* The request says what the socket is, no need for the parser's guess */
+	info = evt.netlink.data.diag;
+	info->protocol = ctx->request->protocol;
+	info->change = change;
+	
+	ctx->cb(&evt, ctx->cb_ctx);
+	ctx->events++;
+	
+	free(evt.netlink.data.generic);
+}
+
+/**
+ * Dump message handler, diffs each socket against the table
+ */
+static int dump_valid_handler(struct nl_msg *msg, void *arg)
+{
+	struct dump_ctx *ctx = arg;
+	struct nlmon_diag_dump *dump = ctx->dump;
+	struct nlmsghdr *nlh = nlmsg_hdr(msg);
+	struct inet_diag_msg *diag;
+	struct socket_entry *entry;
+	struct diag_identity id;
+	uint64_t key;
+	int created;
+	
+	if (nlh->nlmsg_type != SOCK_DIAG_BY_FAMILY ||
+	    (size_t)nlmsg_len(nlh) < sizeof(*diag))
+		return NL_SKIP;
+	
+	diag = nlmsg_data(nlh);
+	dump->stats.messages++;
+	
+	memset(&id, 0, sizeof(id));
+	id.family = diag->idiag_family;
+	id.protocol = ctx->request->protocol;
+	id.sport = diag->id.idiag_sport;
+	id.dport = diag->id.idiag_dport;
+	id.inode = diag->idiag_inode;
+	id.ifindex = diag->id.idiag_if;
+	memcpy(id.src, diag->id.idiag_src, sizeof(id.src));
+	memcpy(id.dst, diag->id.idiag_dst, sizeof(id.dst));
+	key = sketch_hash(&id, sizeof(id), dump->seed);
+	
+	entry = id_table_find(&dump->sockets, key);
+	if (entry && memcmp(&entry->id, &id, sizeof(id)) != 0) {
+		/* Collision of hashes, the socket cannot be told apart */
+		dump->stats.untracked++;
+		return NL_OK;
+	}
+	
+	if (!entry) {
+		if (dump->sockets.used >= dump->config.max_sockets ||
+		    !(entry = id_table_get(&dump->sockets, key, &created))) {
+			dump->stats.untracked++;
+			return NL_OK;
+		}
+		entry->id = id;
+		entry->generation = dump->generation;
+		entry->uid = diag->idiag_uid;
+		entry->state = diag->idiag_state;
+		ctx->new_sockets++;
+		if (ctx->emit)
+			dump_report(ctx, nlh, NLMON_DIAG_CHANGE_NEW);
+		return NL_OK;
+	}
+	
+	entry->generation = dump->generation;
+	if (entry->state == diag->idiag_state && entry->uid == diag->idiag_uid)
+		return NL_OK;
+	
+	entry->state = diag->idiag_state;
+	entry->uid = diag->idiag_uid;
+	ctx->changed_sockets++;
+	if (ctx->emit)
+		dump_report(ctx, nlh, NLMON_DIAG_CHANGE_CHANGED);
+	return NL_OK;
+}
+
+static int dump_finish_handler(struct nl_msg *msg, void *arg)
+{
+	struct dump_ctx *ctx = arg;
+	
+	(void)msg;
+	ctx->done = 1;
+	return NL_STOP;
+}
+
+/* Send one request over @sk and diff its replies */
+static int dump_request_run(struct nl_sock *sk, struct nl_cb *cb, struct dump_ctx *ctx,
+                            const struct dump_request *request)
+{
+	struct inet_diag_req_v2 req;
+	struct nl_msg *msg;
+	int ret;
+	
+	msg = nlmsg_alloc_simple(SOCK_DIAG_BY_FAMILY, NLM_F_DUMP);
+	if (!msg)
+		return -ENOMEM;
+	
+	memset(&req, 0, sizeof(req));
+	req.sdiag_family = request->family;
+	req.sdiag_protocol = request->protocol;
+	req.idiag_states = request->states ? request->states : ~0u;
+	
+	ret = nlmsg_append(msg, &req, sizeof(req), NLMSG_ALIGNTO);
+	if (ret == 0 && request->bytecode_len)
+		ret = nla_put(msg, INET_DIAG_REQ_BYTECODE, request->bytecode_len,
+		              request->bytecode);
+	if (ret == 0)
+		ret = nl_send_auto_complete(sk, msg);
+	nlmsg_free(msg);
+	if (ret < 0)
+		return ret;
+	
+	ctx->request = request;
+	ctx->done = 0;
+	while (!ctx->done) {
+		errno = 0;
+		ret = nl_recvmsgs(sk, cb);
+		if (ret < 0)
+			return ret;
+		
+		/* Receive timed out before NLMSG_DONE */
+		if (!ctx->done && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return -ETIMEDOUT;
+	}
+	
+	return 0;
+}
+
+/* Build the event of a socket the last dump did not see */
+static void dump_report_gone(struct dump_ctx *ctx, const struct socket_entry *entry)
+{
+	struct nlmon_diag_info info;
+	struct nlmon_event evt;
+	
+	memset(&info, 0, sizeof(info));
+	info.family = entry->id.family;
+	info.state = entry->state;
+	info.protocol = entry->id.protocol;
+	info.src_port = ntohs(entry->id.sport);
+	info.dst_port = ntohs(entry->id.dport);
+	info.inode = entry->id.inode;
+	info.uid = entry->uid;
+	info.change = NLMON_DIAG_CHANGE_GONE;
+	inet_ntop(info.family, entry->id.src, info.src_addr, sizeof(info.src_addr));
+	inet_ntop(info.family, entry->id.dst, info.dst_addr, sizeof(info.dst_addr));
+	
+	memset(&evt, 0, sizeof(evt));
+	evt.timestamp = nlmon_clock_realtime_ns();
+	evt.netlink.protocol = NETLINK_SOCK_DIAG;
+	evt.netlink.msg_type = SOCK_DIAG_BY_FAMILY;
+	evt.event_type = SOCK_DIAG_BY_FAMILY;
+	evt.netlink.data.diag = &info;
+	if (entry->id.ifindex)
+		snprintf(evt.interface, sizeof(evt.interface), "if%u", entry->id.ifindex);
+	
+	ctx->cb(&evt, ctx->cb_ctx);
+	ctx->events++;
+}
+
+/**
+ * Remove the sockets not seen by the current dump
+ *
+ * Removal shifts later entries back into the freed slot, so the slot is
+ * looked at again before moving on.
+ */
+static int dump_sweep(struct dump_ctx *ctx)
+{
+	struct nlmon_diag_dump *dump = ctx->dump;
+	struct socket_entry *entry, gone;
+	int removed = 0;
+	size_t i = 0;
+	
+	while (i < dump->sockets.size) {
+		entry = (struct socket_entry *)id_table_slot(&dump->sockets, i);
+		if (!entry->slot.used || entry->generation == dump->generation) {
+			i++;
+			continue;
+		}
+		
+		gone = *entry;
+		id_table_remove(&dump->sockets, entry);
+		removed++;
+		if (ctx->emit)
+			dump_report_gone(ctx, &gone);
+	}
+	
+	return removed;
+}
+
+/* Stretch the interval while nothing changes, shrink it under churn */
+static void dump_adapt(struct nlmon_diag_dump *dump, uint64_t changes)
+{
+	unsigned int interval = dump->interval;
+	
+	if (changes == 0) {
+		interval = interval > dump->config.max_interval / 2 ?
+		           dump->config.max_interval : interval * 2;
+	} else if (changes * 100 >= (uint64_t)dump->sockets.used * DUMP_CHURN_PERCENT) {
+		interval /= 2;
+		if (interval < dump->config.min_interval)
+			interval = dump->config.min_interval;
+	}
+	
+	dump->interval = interval;
+}
+
+/**
+ * Dump the filtered sockets now and report the differences
+ */
+int nlmon_diag_dump_run(struct nlmon_diag_dump *dump, nlmon_diag_dump_cb cb, void *ctx)
+{
+	struct timeval timeout = { .tv_sec = DUMP_TIMEOUT_SEC };
+	struct dump_ctx dctx;
+	struct nl_sock *sk;
+	struct nl_cb *nlcb;
+	int baseline, gone;
+	size_t i;
+	int ret = 0;
+	
+	if (!dump || !cb)
+		return -EINVAL;
+	
+	baseline = dump->last_dump == 0;
+	
+	memset(&dctx, 0, sizeof(dctx));
+	dctx.dump = dump;
+	dctx.cb = cb;
+	dctx.cb_ctx = ctx;
+	dctx.emit = !(baseline && dump->config.silent_baseline);
+	
+	/* Private blocking socket so dump replies never mix with the diag socket's */
+	sk = nl_socket_alloc();
+	if (!sk)
+		return -ENOMEM;
+	
+	ret = nl_connect(sk, NETLINK_SOCK_DIAG);
+	if (ret < 0) {
+		nl_socket_free(sk);
+		return ret;
+	}
+	nl_socket_set_buffer_size(sk, DUMP_SOCK_RCVBUF, 0);
+	
+	/* Never stall the caller on a dump the kernel abandoned */
+	setsockopt(nl_socket_get_fd(sk), SOL_SOCKET, SO_RCVTIMEO,
+	           &timeout, sizeof(timeout));
+	
+	nlcb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (!nlcb) {
+		nl_close(sk);
+		nl_socket_free(sk);
+		return -ENOMEM;
+	}
+	nl_cb_set(nlcb, NL_CB_VALID, NL_CB_CUSTOM, dump_valid_handler, &dctx);
+	nl_cb_set(nlcb, NL_CB_FINISH, NL_CB_CUSTOM, dump_finish_handler, &dctx);
+	
+	dump->generation++;
+	for (i = 0; i < dump->request_count; i++) {
+		ret = dump_request_run(sk, nlcb, &dctx, &dump->requests[i]);
+		if (ret < 0)
+			break;
+	}
+	
+	nl_cb_put(nlcb);
+	nl_close(sk);
+	nl_socket_free(sk);
+	
+	dump->last_dump = nlmon_clock_seconds();
+	
+	/* Sockets of requests never answered are not gone */
+	if (ret < 0) {
+		dump->stats.failures++;
+		nlmon_nl_log_error("NETLINK_SOCK_DIAG dump failed", ret);
+		return ret;
+	}
+	
+	gone = dump_sweep(&dctx);
+	
+	dump->stats.dumps++;
+	dump->stats.sockets_new += dctx.new_sockets;
+	dump->stats.sockets_changed += dctx.changed_sockets;
+	dump->stats.sockets_gone += gone;
+	if (!baseline)
+		dump_adapt(dump, (uint64_t)dctx.new_sockets + dctx.changed_sockets + gone);
+	
+	return dctx.events;
+}
+
+/**
+ * Check whether the next dump is due
+ */
+bool nlmon_diag_dump_due(struct nlmon_diag_dump *dump, time_t now)
+{
+	if (!dump)
+		return false;
+	
+	return dump->last_dump == 0 || now - dump->last_dump >= (time_t)dump->interval;
+}
+
+/**
+ * Get dumper statistics
+ */
+void nlmon_diag_dump_get_stats(struct nlmon_diag_dump *dump, struct nlmon_diag_dump_stats *stats)
+{
+	if (!dump || !stats)
+		return;
+	
+	*stats = dump->stats;
+	stats->sockets = dump->sockets.used;
+	stats->interval = dump->interval;
+}
+
+static void dump_deliver(struct nlmon_event *evt, void *ctx)
+{
+	nlmon_nl_deliver_event(ctx, evt);
+}
+
+/**
+ * Run a dump through a manager if one is due
+ */
+int nlmon_nl_diag_dump_poll(struct nlmon_nl_manager *mgr, struct nlmon_diag_dump *dump)
+{
+	if (!mgr || !dump)
+		return -EINVAL;
+	
+	if (!nlmon_diag_dump_due(dump, nlmon_clock_seconds()))
+		return 0;
+	
+	return nlmon_diag_dump_run(dump, dump_deliver, mgr);
+}
@@ -0,0 +1,186 @@
+/* nlmon_nl_dispatch.c - Per message type dispatch tables
+ *
+ * The handlers of every protocol, the classifier, the lazy decoder, the
+ * table decoders and the payload accounting used to switch on the message
+ * type each, several times per message. All of it is here once, in const
+ * tables indexed by message type.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <linux/rtnetlink.h>
+#include <linux/genetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+
+#include "nlmon_netlink.h"
+#include "nlmon_nl_dispatch.h"
+#include "nlmon_nl_route.h"
+#include "nlmon_nl_genl.h"
+#include "nlmon_nl_diag.h"
+#include "nlmon_nl_netfilter.h"
+
+/* Notifications go to every consumer, dump requests echoed back to none */
+#define ROUTE_SUBS (NLMON_NL_SUB_EVENTS | NLMON_NL_SUB_CACHE | NLMON_NL_SUB_STATE)
+
+#define RTNL_MSG(type, cls, hdr, info, parser, table, cache, subs) \
+	[type] = { .name = #type, .msg_class = (cls), .hdrlen = sizeof(hdr), \
+	           .subscribers = (subs), .payload_size = sizeof(info), .parse = (parser), \
+	           .decoder = (table), .cache_update = (cache) }
+
+static const struct nlmon_nl_msg_desc route_msgs[RTM_GETNEIGH + 1] = {
+	RTNL_MSG(RTM_NEWLINK, MSG_CLASS_LINK, struct ifinfomsg, struct nlmon_link_info,
+	         nlmon_parse_link_msg, &nlmon_nl_link_decoder, nlmon_nl_cache_update_link, ROUTE_SUBS),
+	RTNL_MSG(RTM_DELLINK, MSG_CLASS_LINK, struct ifinfomsg, struct nlmon_link_info,
+	         nlmon_parse_link_msg, &nlmon_nl_link_decoder, nlmon_nl_cache_update_link, ROUTE_SUBS),
+	RTNL_MSG(RTM_GETLINK, MSG_CLASS_LINK, struct ifinfomsg, struct nlmon_link_info,
+	         nlmon_parse_link_msg, &nlmon_nl_link_decoder, NULL, 0),
+	
+	RTNL_MSG(RTM_NEWADDR, MSG_CLASS_ADDR, struct ifaddrmsg, struct nlmon_addr_info,
+	         nlmon_parse_addr_msg, &nlmon_nl_addr_decoder, nlmon_nl_cache_update_addr, ROUTE_SUBS),
+	RTNL_MSG(RTM_DELADDR, MSG_CLASS_ADDR, struct ifaddrmsg, struct nlmon_addr_info,
+	         nlmon_parse_addr_msg, &nlmon_nl_addr_decoder, nlmon_nl_cache_update_addr, ROUTE_SUBS),
+	RTNL_MSG(RTM_GETADDR, MSG_CLASS_ADDR, struct ifaddrmsg, struct nlmon_addr_info,
+	         nlmon_parse_addr_msg, &nlmon_nl_addr_decoder, NULL, 0),
+	
+	RTNL_MSG(RTM_NEWROUTE, MSG_CLASS_ROUTE, struct rtmsg, struct nlmon_route_info,
+	         nlmon_parse_route_msg, &nlmon_nl_route_decoder, nlmon_nl_cache_update_route, ROUTE_SUBS),
+	RTNL_MSG(RTM_DELROUTE, MSG_CLASS_ROUTE, struct rtmsg, struct nlmon_route_info,
+	         nlmon_parse_route_msg, &nlmon_nl_route_decoder, nlmon_nl_cache_update_route, ROUTE_SUBS),
+	RTNL_MSG(RTM_GETROUTE, MSG_CLASS_ROUTE, struct rtmsg, struct nlmon_route_info,
+	         nlmon_parse_route_msg, &nlmon_nl_route_decoder, NULL, 0),
+	
+	/* Neighbors are neither cached nor part of the resync baseline */
+	RTNL_MSG(RTM_NEWNEIGH, MSG_CLASS_NEIGH, struct ndmsg, struct nlmon_neigh_info,
+	         nlmon_parse_neigh_msg, &nlmon_nl_neigh_decoder, NULL, NLMON_NL_SUB_EVENTS),
+	RTNL_MSG(RTM_DELNEIGH, MSG_CLASS_NEIGH, struct ndmsg, struct nlmon_neigh_info,
+	         nlmon_parse_neigh_msg, &nlmon_nl_neigh_decoder, NULL, NLMON_NL_SUB_EVENTS),
+	RTNL_MSG(RTM_GETNEIGH, MSG_CLASS_NEIGH, struct ndmsg, struct nlmon_neigh_info,
+	         nlmon_parse_neigh_msg, &nlmon_nl_neigh_decoder, NULL, 0),
+};
+
+static const struct nlmon_nl_msg_desc diag_msgs[SOCK_DIAG_BY_FAMILY + 1] = {
+	[SOCK_DIAG_BY_FAMILY] = {
+		.name = "SOCK_DIAG_BY_FAMILY",
+		.msg_class = MSG_CLASS_OTHER,
+		.hdrlen = sizeof(struct inet_diag_msg),
+		.subscribers = NLMON_NL_SUB_EVENTS,
+		.payload_size = sizeof(struct nlmon_diag_info),
+		.parse = nlmon_parse_inet_diag_msg,
+	},
+};
+
+#define CT_MSG(type) \
+	[type] = { .name = #type, .msg_class = MSG_CLASS_OTHER, .hdrlen = sizeof(struct nfgenmsg), \
+	           .subscribers = NLMON_NL_SUB_EVENTS, .payload_size = sizeof(struct nlmon_ct_info), \
+	           .parse = nlmon_parse_conntrack_msg, .decoder = &nlmon_nl_ct_decoder }
+
+/* Only connection tracking is decoded, the other subsystems are skipped */
+static const struct nlmon_nl_msg_desc nf_msgs[NFNL_SUBSYS_COUNT][IPCTNL_MSG_MAX] = {
+	[NFNL_SUBSYS_CTNETLINK] = {
+		CT_MSG(IPCTNL_MSG_CT_NEW),
+		CT_MSG(IPCTNL_MSG_CT_GET),
+		CT_MSG(IPCTNL_MSG_CT_DELETE),
+	},
+};
+
+/* The controller has a fixed ID and feeds the family cache */
+static const struct nlmon_nl_msg_desc genl_ctrl = {
+	.name = "nlctrl",
+	.msg_class = MSG_CLASS_OTHER,
+	.hdrlen = GENL_HDRLEN,
+	.subscribers = NLMON_NL_SUB_EVENTS | NLMON_NL_SUB_FAMILY,
+};
+
+/* Families with IDs from the controller, by name */
+static const struct nlmon_nl_msg_desc genl_families[] = {
+	{
+		.name = "nl80211",
+		.msg_class = MSG_CLASS_OTHER,
+		.hdrlen = GENL_HDRLEN,
+		.subscribers = NLMON_NL_SUB_EVENTS,
+		.payload_size = sizeof(struct nlmon_nl80211_info),
+		.parse = nlmon_parse_nl80211_msg,
+	},
+};
+
+/* Any other family only carries its header */
+static const struct nlmon_nl_msg_desc genl_other = {
+	.name = "genl",
+	.msg_class = MSG_CLASS_OTHER,
+	.hdrlen = GENL_HDRLEN,
+	.subscribers = NLMON_NL_SUB_EVENTS,
+};
+
+/* Family ID to descriptor, filled in as families are seen */
+static const struct nlmon_nl_msg_desc *_Atomic genl_bound[GENL_MAX_ID + 1];
+
+/* Whether a table slot has an entry */
+static inline const struct nlmon_nl_msg_desc *msg_entry(const struct nlmon_nl_msg_desc *desc)
+{
+	return desc->name ? desc : NULL;
+}
+
+const struct nlmon_nl_msg_desc *nlmon_nl_msg_lookup(int protocol, uint16_t msg_type)
+{
+	switch (protocol) {
+	case NETLINK_ROUTE:
+		if (msg_type >= sizeof(route_msgs) / sizeof(route_msgs[0]))
+			return NULL;
+		return msg_entry(&route_msgs[msg_type]);
+	
+	case NETLINK_GENERIC:
+		if (msg_type == GENL_ID_CTRL)
+			return &genl_ctrl;
+		if (msg_type > GENL_MAX_ID)
+			return NULL;
+		return atomic_load_explicit(&genl_bound[msg_type], memory_order_acquire);
+	
+	case NETLINK_SOCK_DIAG:
+		if (msg_type >= sizeof(diag_msgs) / sizeof(diag_msgs[0]))
+			return NULL;
+		return msg_entry(&diag_msgs[msg_type]);
+	
+	case NETLINK_NETFILTER:
+		if (NFNL_SUBSYS_ID(msg_type) >= NFNL_SUBSYS_COUNT ||
+		    NFNL_MSG_TYPE(msg_type) >= IPCTNL_MSG_MAX)
+			return NULL;
+		return msg_entry(&nf_msgs[NFNL_SUBSYS_ID(msg_type)][NFNL_MSG_TYPE(msg_type)]);
+	
+	default:
+		return NULL;
+	}
+}
+
+const struct nlmon_nl_msg_desc *nlmon_nl_msg_bind_genl(uint16_t family_id, const char *family)
+{
+	const struct nlmon_nl_msg_desc *desc = &genl_other;
+	size_t i;
+	
+	if (family_id == GENL_ID_CTRL)
+		return &genl_ctrl;
+	if (family_id > GENL_MAX_ID)
+		return NULL;
+	
+	for (i = 0; family && i < sizeof(genl_families) / sizeof(genl_families[0]); i++) {
+		if (strcmp(genl_families[i].name, family) == 0) {
+			desc = &genl_families[i];
+			break;
+		}
+	}
+	
+	atomic_store_explicit(&genl_bound[family_id], desc, memory_order_release);
+	return desc;
+}
+
+void nlmon_nl_msg_unbind_genl(void)
+{
+	size_t i;
+	
+	for (i = 0; i <= GENL_MAX_ID; i++)
+		atomic_store_explicit(&genl_bound[i], NULL, memory_order_relaxed);
+}
@@ -9,6 +9,7 @@
 #include <netlink/errno.h>
 
 #include "nlmon_nl_error.h"
+#include "log_ring.h"
 
 /**
  * Error message strings for nlmon netlink errors
@@ -212,8 +213,6 @@ int nlmon_nl_map_errno(int errno_val)
  * Logging support for netlink operations
  */
 
-#include <stdarg.h>
-#include <time.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 
@@ -247,62 +246,28 @@ void nlmon_nl_set_dump_on_error(int enable)
 	dump_on_error = enable;
 }
 
-/**
- * Get timestamp string for logging
+/*
+ * Log through the deferred log ring. A disabled level costs one compare,
+ * its arguments are not evaluated.
  */
-static void get_timestamp(char *buf, size_t len)
-{
-	time_t now;
-	struct tm *tm_info;
-	
-	time(&now);
-	tm_info = localtime(&now);
-	strftime(buf, len, "%Y-%m-%d %H:%M:%S", tm_info);
-}
+#define nlmon_nl_log(level, fmt, ...) do {                                      \
+	if ((level) <= current_log_level)                                       \
+		NLMON_LOG(level, "NETLINK", fmt, ##__VA_ARGS__);                \
+} while (0)
 
-/**
- * Internal logging function
- */
-static void nlmon_nl_log(enum nlmon_nl_log_level level, const char *fmt, ...)
+#define nlmon_nl_log_render(level, render, ...) do {                            \
+	if ((level) <= current_log_level)                                       \
+		NLMON_LOG_RENDER(level, "NETLINK", render, ##__VA_ARGS__);      \
+} while (0)
+
+/* strerror() text is not static, so it is looked up when formatting */
+static int render_errno(const struct nlmon_log_record *rec, char *buf, size_t len)
 {
-	va_list args;
-	char timestamp[32];
-	const char *level_str;
-	
-	/* Check if this message should be logged */
-	if (level > current_log_level)
-		return;
+	int error = (int)rec->args[1];
 	
-	/* Get level string */
-	switch (level) {
-	case NLMON_NL_LOG_ERROR:
-		level_str = "ERROR";
-		break;
-	case NLMON_NL_LOG_WARN:
-		level_str = "WARN";
-		break;
-	case NLMON_NL_LOG_INFO:
-		level_str = "INFO";
-		break;
-	case NLMON_NL_LOG_DEBUG:
-		level_str = "DEBUG";
-		break;
-	default:
-		level_str = "UNKNOWN";
-		break;
-	}
-	
-	/* Get timestamp */
-	get_timestamp(timestamp, sizeof(timestamp));
-	
-	/* Print log message */
-	fprintf(stderr, "[%s] [NETLINK-%s] ", timestamp, level_str);
-	
-	va_start(args, fmt);
-	vfprintf(stderr, fmt, args);
-	va_end(args);
-	
-	fprintf(stderr, "\n");
+	return snprintf(buf, len, "%s: %s (errno: %d - %s)",
+	                (const char *)(uintptr_t)rec->args[0],
+	                nlmon_nl_strerror(nlmon_nl_map_errno(error)), error, strerror(error));
 }
 
 /**
@@ -320,9 +285,7 @@ void nlmon_nl_log_error(const char *context, int error)
 		             context, nlmon_nl_strerror(nlmon_err), nl_geterror(error));
 	} else if (error > 0) {
 		/* Positive error, likely errno */
-		nlmon_err = nlmon_nl_map_errno(error);
-		nlmon_nl_log(NLMON_NL_LOG_ERROR, "%s: %s (errno: %d - %s)",
-		             context, nlmon_nl_strerror(nlmon_err), error, strerror(error));
+		nlmon_nl_log_render(NLMON_NL_LOG_ERROR, render_errno, context, error);
 	} else {
 		/* No error */
 		nlmon_nl_log(NLMON_NL_LOG_DEBUG, "%s: Success", context);
@@ -427,27 +390,70 @@ static void get_nlmsg_flags_str(uint16_t flags, char *buf, size_t len)
 		snprintf(buf, len, "NONE");
 }
 
+/* Flags are decoded when formatting, args: direction, type, len, flags, seq, pid */
+static int render_message(const struct nlmon_log_record *rec, char *buf, size_t len)
+{
+	char flags_str[256];
+	uint16_t type = (uint16_t)rec->args[1];
+	
+	get_nlmsg_flags_str((uint16_t)rec->args[3], flags_str, sizeof(flags_str));
+	
+	return snprintf(buf, len, "Message %s: type=%s(%u) len=%u flags=%s seq=%u pid=%u",
+	                (const char *)(uintptr_t)rec->args[0],
+	                get_nlmsg_type_name(type), type,
+	                (unsigned int)rec->args[2],
+	                flags_str,
+	                (unsigned int)rec->args[4],
+	                (unsigned int)rec->args[5]);
+}
+
 /**
  * Log netlink message details (for debugging)
  */
 void nlmon_nl_log_message(struct nlmsghdr *nlh, const char *direction)
 {
-	char flags_str[256];
-	
-	if (!nlh || current_log_level < NLMON_NL_LOG_DEBUG)
+	if (!nlh)
 		return;
 	
-	get_nlmsg_flags_str(nlh->nlmsg_flags, flags_str, sizeof(flags_str));
-	
-	nlmon_nl_log(NLMON_NL_LOG_DEBUG,
-	             "Message %s: type=%s(%u) len=%u flags=%s seq=%u pid=%u",
-	             direction,
-	             get_nlmsg_type_name(nlh->nlmsg_type),
-	             nlh->nlmsg_type,
-	             nlh->nlmsg_len,
-	             flags_str,
-	             nlh->nlmsg_seq,
-	             nlh->nlmsg_pid);
+	nlmon_nl_log_render(NLMON_NL_LOG_DEBUG, render_message, direction,
+	                    nlh->nlmsg_type, nlh->nlmsg_len, nlh->nlmsg_flags,
+	                    nlh->nlmsg_seq, nlh->nlmsg_pid);
+}
+
+/* One row of a hex dump, args: offset, length, then up to 16 bytes */
+static int render_dump_row(const struct nlmon_log_record *rec, char *buf, size_t len)
+{
+	unsigned char data[16];
+	char hex_buf[64];
+	char ascii_buf[20];
+	size_t count = rec->args[1];
+	int hex_pos = 0, ascii_pos = 0;
+	size_t j;
+	
+	memcpy(data, &rec->args[2], sizeof(data));
+	
+	for (j = 0; j < 16; j++) {
+		if (j < count) {
+			hex_pos += snprintf(hex_buf + hex_pos, sizeof(hex_buf) - hex_pos,
+			                    "%02x ", data[j]);
+			
+			/* Print ASCII representation */
+			if (data[j] >= 32 && data[j] <= 126)
+				ascii_buf[ascii_pos++] = data[j];
+			else
+				ascii_buf[ascii_pos++] = '.';
+		} else {
+			hex_pos += snprintf(hex_buf + hex_pos, sizeof(hex_buf) - hex_pos, "   ");
+		}
+		
+		/* Add extra space after 8 bytes */
+		if (j == 7)
+			hex_pos += snprintf(hex_buf + hex_pos, sizeof(hex_buf) - hex_pos, " ");
+	}
+	
+	ascii_buf[ascii_pos] = '\0';
+	return snprintf(buf, len, "  %04zx: %-48s  |%s|", (size_t)rec->args[0],
+	                hex_buf, ascii_buf);
 }
 
 /**
@@ -456,10 +462,8 @@ void nlmon_nl_log_message(struct nlmsghdr *nlh, const char *direction)
 void nlmon_nl_dump_message(struct nlmsghdr *nlh, size_t len)
 {
 	unsigned char *data;
-	size_t i, j;
-	char hex_buf[64];
-	char ascii_buf[20];
-	int hex_pos, ascii_pos;
+	uint64_t row[2];
+	size_t i;
 	
 	if (!nlh || !dump_on_error)
 		return;
@@ -471,39 +475,12 @@ void nlmon_nl_dump_message(struct nlmsghdr *nlh, size_t len)
 	
 	nlmon_nl_log(NLMON_NL_LOG_DEBUG, "Message dump (%zu bytes):", len);
 	
+	/* The bytes travel in the record, the message may be gone by the time it is formatted */
 	for (i = 0; i < len; i += 16) {
-		hex_pos = 0;
-		ascii_pos = 0;
-		
-		/* Print offset */
-		fprintf(stderr, "  %04zx: ", i);
-		
-		/* Print hex bytes */
-		for (j = 0; j < 16; j++) {
-			if (i + j < len) {
-				hex_pos += snprintf(hex_buf + hex_pos,
-				                    sizeof(hex_buf) - hex_pos,
-				                    "%02x ", data[i + j]);
-				
-				/* Print ASCII representation */
-				if (data[i + j] >= 32 && data[i + j] <= 126)
-					ascii_buf[ascii_pos++] = data[i + j];
-				else
-					ascii_buf[ascii_pos++] = '.';
-			} else {
-				hex_pos += snprintf(hex_buf + hex_pos,
-				                    sizeof(hex_buf) - hex_pos,
-				                    "   ");
-			}
-			
-			/* Add extra space after 8 bytes */
-			if (j == 7)
-				hex_pos += snprintf(hex_buf + hex_pos,
-				                    sizeof(hex_buf) - hex_pos,
-				                    " ");
-		}
+		size_t count = len - i < 16 ? len - i : 16;
 		
-		ascii_buf[ascii_pos] = '\0';
-		fprintf(stderr, "%-48s  |%s|\n", hex_buf, ascii_buf);
+		memset(row, 0, sizeof(row));
+		memcpy(row, data + i, count);
+		nlmon_nl_log_render(NLMON_NL_LOG_DEBUG, render_dump_row, i, count, row[0], row[1]);
 	}
 }
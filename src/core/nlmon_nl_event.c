@@ -16,22 +16,14 @@
 #include <netlink/msg.h>
 
 #include "nlmon_nl_event.h"
+#include "nlmon_netlink.h"
+#include "nlmon_nl_dispatch.h"
 #include "event_processor.h"
 #include "nlmon_nl_route.h"
 #include "nlmon_nl_genl.h"
 #include "nlmon_nl_diag.h"
 #include "nlmon_nl_netfilter.h"
 
-/**
- * Get current timestamp in microseconds
- */
-static uint64_t get_timestamp_us(void)
-{
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	return (uint64_t)tv.tv_sec * 1000000ULL + (uint64_t)tv.tv_usec;
-}
-
 /**
  * Extract common netlink header information
  */
@@ -47,7 +39,7 @@ void nlmon_nl_extract_header(struct nlmsghdr *nlh, struct nlmon_event *evt)
 	evt->netlink.pid = nlh->nlmsg_pid;
 	
 	/* Set timestamp */
-	evt->timestamp = get_timestamp_us();
+	evt->timestamp = nlmon_nl_recv_timestamp();
 }
 
 /**
@@ -74,15 +66,21 @@ int nlmon_nl_parse_attributes(struct nlmsghdr *nlh, int hdrlen,
  */
 int nlmon_nl_msg_to_event(struct nl_msg *msg, struct nlmon_event *evt, int protocol)
 {
-	struct nlmsghdr *nlh;
-	int ret = 0;
-	
-	if (!msg || !evt)
+	if (!msg)
 		return -EINVAL;
 	
-	/* Get netlink message header */
-	nlh = nlmsg_hdr(msg);
-	if (!nlh)
+	return nlmon_nl_parse_message(nlmsg_hdr(msg), evt, protocol);
+}
+
+/**
+ * Convert a bare netlink message to nlmon event
+ */
+int nlmon_nl_parse_message(struct nlmsghdr *nlh, struct nlmon_event *evt, int protocol)
+{
+	const struct nlmon_nl_msg_desc *desc;
+	int ret = 0;
+	
+	if (!nlh || !evt)
 		return -EINVAL;
 	
 	/* Initialize event structure */
@@ -97,41 +95,15 @@ int nlmon_nl_msg_to_event(struct nl_msg *msg, struct nlmon_event *evt, int proto
 	/* Call protocol-specific parser based on protocol */
 	switch (protocol) {
 	case NETLINK_ROUTE:
-		/* Route protocol messages */
-		switch (nlh->nlmsg_type) {
-		case RTM_NEWLINK:
-		case RTM_DELLINK:
-		case RTM_GETLINK:
-			ret = nlmon_parse_link_msg(nlh, evt);
-			evt->event_type = nlh->nlmsg_type;
-			break;
-			
-		case RTM_NEWADDR:
-		case RTM_DELADDR:
-		case RTM_GETADDR:
-			ret = nlmon_parse_addr_msg(nlh, evt);
-			evt->event_type = nlh->nlmsg_type;
-			break;
-			
-		case RTM_NEWROUTE:
-		case RTM_DELROUTE:
-		case RTM_GETROUTE:
-			ret = nlmon_parse_route_msg(nlh, evt);
-			evt->event_type = nlh->nlmsg_type;
-			break;
-			
-		case RTM_NEWNEIGH:
-		case RTM_DELNEIGH:
-		case RTM_GETNEIGH:
-			ret = nlmon_parse_neigh_msg(nlh, evt);
-			evt->event_type = nlh->nlmsg_type;
-			break;
-			
-		default:
+		/* Route protocol messages, dump requests included */
+		desc = nlmon_nl_msg_lookup(protocol, nlh->nlmsg_type);
+		if (!desc) {
 			/* Unknown route message type */
 			ret = -ENOTSUP;
 			break;
 		}
+		ret = desc->parse(nlh, evt);
+		evt->event_type = nlh->nlmsg_type;
 		break;
 		
 	case NETLINK_GENERIC:
@@ -175,3 +147,21 @@ int nlmon_nl_msg_to_event(struct nl_msg *msg, struct nlmon_event *evt, int proto
 	
 	return ret;
 }
+
+/**
+ * Get size of the parsed attribute payload attached to an event
+ */
+size_t nlmon_nl_event_payload_size(const struct nlmon_event *evt)
+{
+	const struct nlmon_nl_msg_desc *desc;
+	
+	if (!evt || !evt->netlink.data.generic)
+		return 0;
+	
+	/* Only nl80211 messages carry data on generic netlink */
+	if (evt->netlink.protocol == NETLINK_GENERIC)
+		return sizeof(struct nlmon_nl80211_info);
+	
+	desc = nlmon_nl_msg_lookup(evt->netlink.protocol, evt->netlink.msg_type);
+	return desc && (desc->subscribers & NLMON_NL_SUB_EVENTS) ? desc->payload_size : 0;
+}
@@ -0,0 +1,473 @@
+/* nlmon_nl_family.c - Generic netlink family cache
+ *
+ * Families live in an open addressing table keyed by family ID. Kernel
+ * family IDs are small and allocated in sequence, so the home slot of
+ * an ID is usually the entry itself and a lookup is one array access.
+ * One reader/writer lock covers the table: lookups run on every
+ * generic netlink message, updates only when families come and go.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <linux/genetlink.h>
+
+#include <netlink/netlink.h>
+#include <netlink/msg.h>
+#include <netlink/attr.h>
+#include <netlink/handlers.h>
+#include <netlink/socket.h>
+#include <netlink/genl/genl.h>
+
+#include "nlmon_nl_family.h"
+
+#define FAMILY_SLOTS 128                  /* Power of two */
+#define FAMILY_SLOT_MASK (FAMILY_SLOTS - 1)
+#define FAMILY_MAX_USED (FAMILY_SLOTS * 3 / 4)
+
+/* Cache slot */
+struct family_slot {
+	struct nlmon_genl_family family;
+	uint32_t generation;             /* Fill that last saw the family */
+	uint8_t used;
+};
+
+/* State of a running cache fill */
+struct family_dump {
+	uint32_t generation;
+	int count;
+	int error;
+};
+
+static struct family_slot g_slots[FAMILY_SLOTS];
+static unsigned int g_used;
+static uint32_t g_generation;
+static pthread_rwlock_t g_family_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static inline size_t family_home(uint16_t id)
+{
+	return id & FAMILY_SLOT_MASK;
+}
+
+/* Slot of a family ID, or -1. Called with the lock held. */
+static int family_slot_find(uint16_t id)
+{
+	size_t i = family_home(id);
+	size_t n;
+	
+	for (n = 0; n < FAMILY_SLOTS && g_slots[i].used; n++) {
+		if (g_slots[i].family.id == id)
+			return (int)i;
+		i = (i + 1) & FAMILY_SLOT_MASK;
+	}
+	return -1;
+}
+
+/* Slot for a family ID, taking a free one if it is new. Called with the
+ * write lock held. */
+static struct family_slot *family_slot_get(uint16_t id)
+{
+	size_t i = family_home(id);
+	int found = family_slot_find(id);
+	
+	if (found >= 0)
+		return &g_slots[found];
+	
+	if (g_used >= FAMILY_MAX_USED)
+		return NULL;
+	
+	while (g_slots[i].used)
+		i = (i + 1) & FAMILY_SLOT_MASK;
+	
+	memset(&g_slots[i], 0, sizeof(g_slots[i]));
+	g_slots[i].family.id = id;
+	g_slots[i].used = 1;
+	g_used++;
+	return &g_slots[i];
+}
+
+/* Free a slot, shifting later entries of its probe run back so lookups
+ * never need tombstones. Called with the write lock held. */
+static void family_slot_remove(size_t i)
+{
+	size_t j = i;
+	
+	for (;;) {
+		size_t home;
+		
+		j = (j + 1) & FAMILY_SLOT_MASK;
+		if (!g_slots[j].used)
+			break;
+		
+		/* The entry at j may move to i unless its home lies in (i, j] */
+		home = family_home(g_slots[j].family.id);
+		if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+			g_slots[i] = g_slots[j];
+			i = j;
+		}
+	}
+	
+	g_slots[i].used = 0;
+	g_used--;
+}
+
+/* Parse the family, and its multicast groups, of a controller message */
+static int family_parse(const struct nlmsghdr *nlh, struct nlmon_genl_family *family,
+                        int *has_name)
+{
+	struct nlattr *tb[CTRL_ATTR_MAX + 1];
+	struct nlattr *grp;
+	int remaining;
+	int ret;
+	
+	ret = nlmsg_parse((struct nlmsghdr *)nlh, GENL_HDRLEN, tb, CTRL_ATTR_MAX, NULL);
+	if (ret < 0)
+		return ret;
+	
+	if (!tb[CTRL_ATTR_FAMILY_ID])
+		return -EINVAL;
+	
+	memset(family, 0, sizeof(*family));
+	family->id = nla_get_u16(tb[CTRL_ATTR_FAMILY_ID]);
+	
+	*has_name = 0;
+	if (tb[CTRL_ATTR_FAMILY_NAME]) {
+		nla_strlcpy(family->name, tb[CTRL_ATTR_FAMILY_NAME], sizeof(family->name));
+		*has_name = 1;
+	}
+	
+	if (tb[CTRL_ATTR_VERSION])
+		family->version = nla_get_u32(tb[CTRL_ATTR_VERSION]);
+	
+	if (!tb[CTRL_ATTR_MCAST_GROUPS])
+		return 0;
+	
+	nla_for_each_nested(grp, tb[CTRL_ATTR_MCAST_GROUPS], remaining) {
+		struct nlattr *gtb[CTRL_ATTR_MCAST_GRP_MAX + 1];
+		struct nlmon_genl_mcast_group *g;
+		
+		if (nla_parse_nested(gtb, CTRL_ATTR_MCAST_GRP_MAX, grp, NULL) < 0)
+			continue;
+		if (!gtb[CTRL_ATTR_MCAST_GRP_NAME] || !gtb[CTRL_ATTR_MCAST_GRP_ID])
+			continue;
+		if (family->ngroups >= NLMON_GENL_FAMILY_MAX_GROUPS)
+			break;
+		
+		g = &family->groups[family->ngroups++];
+		g->id = nla_get_u32(gtb[CTRL_ATTR_MCAST_GRP_ID]);
+		nla_strlcpy(g->name, gtb[CTRL_ATTR_MCAST_GRP_NAME], sizeof(g->name));
+	}
+	
+	return 0;
+}
+
+/* Index of a group ID in a family, or -1 */
+static int family_group_index(const struct nlmon_genl_family *family, uint32_t id)
+{
+	unsigned int i;
+	
+	for (i = 0; i < family->ngroups; i++) {
+		if (family->groups[i].id == id)
+			return (int)i;
+	}
+	return -1;
+}
+
+/* Apply a controller message. Called with the write lock held. */
+static int family_apply(const struct nlmsghdr *nlh, uint32_t generation)
+{
+	const struct genlmsghdr *gnlh = nlmsg_data(nlh);
+	struct nlmon_genl_family parsed;
+	struct family_slot *slot;
+	unsigned int i;
+	int has_name;
+	int found;
+	int ret;
+	
+	ret = family_parse(nlh, &parsed, &has_name);
+	if (ret < 0)
+		return ret;
+	
+	switch (gnlh->cmd) {
+	case CTRL_CMD_NEWFAMILY:
+		if (!has_name)
+			return -EINVAL;
+		slot = family_slot_get(parsed.id);
+		if (!slot)
+			return -ENOSPC;
+		slot->family = parsed;
+		slot->generation = generation;
+		return 1;
+		
+	case CTRL_CMD_DELFAMILY:
+		found = family_slot_find(parsed.id);
+		if (found < 0)
+			return 0;
+		family_slot_remove((size_t)found);
+		return 1;
+		
+	case CTRL_CMD_NEWMCAST_GRP:
+		found = family_slot_find(parsed.id);
+		if (found < 0) {
+			if (!has_name)
+				return 0;
+			slot = family_slot_get(parsed.id);
+			if (!slot)
+				return -ENOSPC;
+			slot->family = parsed;
+			slot->generation = generation;
+			return 1;
+		}
+		
+		slot = &g_slots[found];
+		for (i = 0; i < parsed.ngroups; i++) {
+			if (family_group_index(&slot->family, parsed.groups[i].id) >= 0)
+				continue;
+			if (slot->family.ngroups >= NLMON_GENL_FAMILY_MAX_GROUPS)
+				break;
+			slot->family.groups[slot->family.ngroups++] = parsed.groups[i];
+		}
+		return 1;
+		
+	case CTRL_CMD_DELMCAST_GRP:
+		found = family_slot_find(parsed.id);
+		if (found < 0)
+			return 0;
+		
+		slot = &g_slots[found];
+		for (i = 0; i < parsed.ngroups; i++) {
+			int idx = family_group_index(&slot->family, parsed.groups[i].id);
+			
+			if (idx < 0)
+				continue;
+			slot->family.ngroups--;
+			slot->family.groups[idx] = slot->family.groups[slot->family.ngroups];
+		}
+		return 1;
+		
+	default:
+		return 0;
+	}
+}
+
+static int family_dump_valid(struct nl_msg *msg, void *arg)
+{
+	struct family_dump *dump = arg;
+	int ret;
+	
+	pthread_rwlock_wrlock(&g_family_lock);
+	ret = family_apply(nlmsg_hdr(msg), dump->generation);
+	pthread_rwlock_unlock(&g_family_lock);
+	
+	if (ret > 0)
+		dump->count++;
+	else if (ret < 0 && !dump->error)
+		dump->error = ret;
+	
+	return NL_OK;
+}
+
+/**
+ * Fill the cache from the controller
+ */
+int nlmon_genl_family_cache_fill(struct nl_sock *sock)
+{
+	struct family_dump dump = {0};
+	struct nl_msg *msg;
+	struct nl_cb *cb;
+	size_t i;
+	int ret;
+	
+	if (!sock)
+		return -EINVAL;
+	
+	msg = nlmsg_alloc();
+	if (!msg)
+		return -ENOMEM;
+	
+	cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (!cb) {
+		ret = -ENOMEM;
+		goto out_msg;
+	}
+	
+	if (!genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, GENL_ID_CTRL, 0, NLM_F_DUMP,
+	                 CTRL_CMD_GETFAMILY, 1)) {
+		ret = -ENOMEM;
+		goto out_cb;
+	}
+	
+	pthread_rwlock_wrlock(&g_family_lock);
+	dump.generation = ++g_generation;
+	pthread_rwlock_unlock(&g_family_lock);
+	
+	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, family_dump_valid, &dump);
+	
+	ret = nl_send_auto_complete(sock, msg);
+	if (ret < 0)
+		goto out_cb;
+	
+	ret = nl_recvmsgs(sock, cb);
+	if (ret < 0)
+		goto out_cb;
+	
+	if (dump.error)
+		fprintf(stderr, "Warning: Failed to cache some generic netlink families: %s\n",
+		        strerror(-dump.error));
+	
+	/* Drop the families the dump no longer listed */
+	pthread_rwlock_wrlock(&g_family_lock);
+	for (i = 0; i < FAMILY_SLOTS; ) {
+		if (g_slots[i].used && g_slots[i].generation != dump.generation)
+			family_slot_remove(i);    /* Re-check i, an entry may have moved in */
+		else
+			i++;
+	}
+	pthread_rwlock_unlock(&g_family_lock);
+	
+	ret = dump.count;
+	
+out_cb:
+	nl_cb_put(cb);
+out_msg:
+	nlmsg_free(msg);
+	return ret;
+}
+
+/**
+ * Join the nlctrl notify group
+ */
+int nlmon_genl_family_cache_subscribe(struct nl_sock *sock)
+{
+	int group;
+	
+	if (!sock)
+		return -EINVAL;
+	
+	group = nlmon_genl_family_group("nlctrl", "notify");
+	if (group < 0)
+		return group;
+	
+	return nl_socket_add_memberships(sock, group, 0);
+}
+
+/**
+ * Apply a controller message
+ */
+int nlmon_genl_family_cache_update(const struct nlmsghdr *nlh)
+{
+	int ret;
+	
+	if (!nlh)
+		return -EINVAL;
+	
+	if (nlh->nlmsg_type != GENL_ID_CTRL || nlh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+		return 0;
+	
+	pthread_rwlock_wrlock(&g_family_lock);
+	ret = family_apply(nlh, g_generation);
+	pthread_rwlock_unlock(&g_family_lock);
+	
+	return ret;
+}
+
+/**
+ * Drop all cached families
+ */
+void nlmon_genl_family_cache_clear(void)
+{
+	pthread_rwlock_wrlock(&g_family_lock);
+	memset(g_slots, 0, sizeof(g_slots));
+	g_used = 0;
+	pthread_rwlock_unlock(&g_family_lock);
+}
+
+/**
+ * Name of a family
+ */
+int nlmon_genl_family_name(uint16_t id, char *buf, size_t len)
+{
+	int found;
+	
+	if (!buf || len == 0)
+		return -EINVAL;
+	
+	pthread_rwlock_rdlock(&g_family_lock);
+	found = family_slot_find(id);
+	if (found >= 0)
+		snprintf(buf, len, "%s", g_slots[found].family.name);
+	pthread_rwlock_unlock(&g_family_lock);
+	
+	return found >= 0 ? 0 : -ENOENT;
+}
+
+/**
+ * Cached family by ID
+ */
+int nlmon_genl_family_lookup(uint16_t id, struct nlmon_genl_family *family)
+{
+	int found;
+	
+	if (!family)
+		return -EINVAL;
+	
+	pthread_rwlock_rdlock(&g_family_lock);
+	found = family_slot_find(id);
+	if (found >= 0)
+		*family = g_slots[found].family;
+	pthread_rwlock_unlock(&g_family_lock);
+	
+	return found >= 0 ? 0 : -ENOENT;
+}
+
+/**
+ * Cached family by name
+ */
+int nlmon_genl_family_find(const char *name, struct nlmon_genl_family *family)
+{
+	int ret = -ENOENT;
+	size_t i;
+	
+	if (!name)
+		return -EINVAL;
+	
+	pthread_rwlock_rdlock(&g_family_lock);
+	for (i = 0; i < FAMILY_SLOTS; i++) {
+		if (!g_slots[i].used || strcmp(g_slots[i].family.name, name) != 0)
+			continue;
+		if (family)
+			*family = g_slots[i].family;
+		ret = g_slots[i].family.id;
+		break;
+	}
+	pthread_rwlock_unlock(&g_family_lock);
+	
+	return ret;
+}
+
+/**
+ * Multicast group ID by name
+ */
+int nlmon_genl_family_group(const char *family, const char *group)
+{
+	struct nlmon_genl_family entry;
+	unsigned int i;
+	
+	if (!family || !group)
+		return -EINVAL;
+	
+	if (nlmon_genl_family_find(family, &entry) < 0)
+		return -ENOENT;
+	
+	for (i = 0; i < entry.ngroups; i++) {
+		if (strcmp(entry.groups[i].name, group) == 0)
+			return (int)entry.groups[i].id;
+	}
+	return -ENOENT;
+}
@@ -21,9 +21,172 @@
 
 #include "nlmon_netlink.h"
 #include "nlmon_nl_genl.h"
+#include "nlmon_nl_family.h"
+#include "nlmon_nl_optimize.h"
+#include "nlmon_nl_dispatch.h"
 #include "event_processor.h"
 #include "qca_vendor.h"
 
+/*
+ * Attribute whitelist
+ *
+ * Each nl80211 attribute with a destination field has a slot. One pass
+ * over the message stores the whitelisted slots and skips every other
+ * attribute by its length, instead of genlmsg_parse() validating and
+ * indexing all NL80211_ATTR_MAX types.
+ */
+enum genl_slot {
+	GENL_SLOT_NONE = 0,
+	GENL_SLOT_WIPHY,
+	GENL_SLOT_IFINDEX,
+	GENL_SLOT_IFTYPE,
+	GENL_SLOT_MAC,
+	GENL_SLOT_FREQ,
+	GENL_SLOT_CHANNEL_TYPE,
+	GENL_SLOT_VENDOR_ID,
+	GENL_SLOT_VENDOR_SUBCMD,
+	GENL_SLOT_VENDOR_DATA,
+	GENL_SLOT_COUNT
+};
+
+#define GENL_SLOT_BIT(slot) (1u << (slot))
+#define GENL_SLOTS_REQUIRED (GENL_SLOT_BIT(GENL_SLOT_VENDOR_ID) | \
+                             GENL_SLOT_BIT(GENL_SLOT_VENDOR_SUBCMD))
+#define GENL_SLOTS_ALL (((1u << GENL_SLOT_COUNT) - 1) & ~GENL_SLOT_BIT(GENL_SLOT_NONE))
+
+static const uint8_t genl_slot_of[NL80211_ATTR_MAX + 1] = {
+	[NL80211_ATTR_WIPHY] = GENL_SLOT_WIPHY,
+	[NL80211_ATTR_IFINDEX] = GENL_SLOT_IFINDEX,
+	[NL80211_ATTR_IFTYPE] = GENL_SLOT_IFTYPE,
+	[NL80211_ATTR_MAC] = GENL_SLOT_MAC,
+	[NL80211_ATTR_WIPHY_FREQ] = GENL_SLOT_FREQ,
+	[NL80211_ATTR_WIPHY_CHANNEL_TYPE] = GENL_SLOT_CHANNEL_TYPE,
+	[NL80211_ATTR_VENDOR_ID] = GENL_SLOT_VENDOR_ID,
+	[NL80211_ATTR_VENDOR_SUBCMD] = GENL_SLOT_VENDOR_SUBCMD,
+	[NL80211_ATTR_VENDOR_DATA] = GENL_SLOT_VENDOR_DATA,
+};
+
+static unsigned int genl_depth = NLMON_GENL_DEPTH_ATTRS;
+static uint32_t genl_slot_mask = GENL_SLOTS_ALL;
+
+/*
+ * QCA vendor data
+ *
+ * Subcommands whose vendor data uses enum qca_wlan_vendor_attr share
+ * one table. Data of other subcommands uses per-command enums and is
+ * only measured.
+ */
+#define QCA_ATTR(field, kind) NL_ATTR(struct nlmon_qca_vendor_info, field, kind)
+
+static const struct nlmon_nl_attr_desc qca_vendor_attr_desc[QCA_WLAN_VENDOR_ATTR_MAX + 1] = {
+	[QCA_WLAN_VENDOR_ATTR_IFINDEX] = QCA_ATTR(ifindex, NLMON_NL_ATTR_U32),
+	[QCA_WLAN_VENDOR_ATTR_MAC_ADDR] = QCA_ATTR(mac, NLMON_NL_ATTR_BINARY),
+	[QCA_WLAN_VENDOR_ATTR_FREQ] = QCA_ATTR(freq, NLMON_NL_ATTR_U32),
+	[QCA_WLAN_VENDOR_ATTR_TSF] = QCA_ATTR(tsf, NLMON_NL_ATTR_U64),
+	[QCA_WLAN_VENDOR_ATTR_FW_STATE] = QCA_ATTR(fw_state, NLMON_NL_ATTR_U8),
+	[QCA_WLAN_VENDOR_ATTR_SETBAND_MASK] = QCA_ATTR(setband_mask, NLMON_NL_ATTR_U32),
+};
+
+static const struct nlmon_nl_attr_table qca_vendor_attr_table = NL_TABLE(qca_vendor_attr_desc);
+
+static const uint32_t qca_vendor_attr_subcmds[] = {
+	QCA_NL80211_VENDOR_SUBCMD_ROAMING,
+	QCA_NL80211_VENDOR_SUBCMD_SETBAND,
+	QCA_NL80211_VENDOR_SUBCMD_GETBAND,
+	QCA_NL80211_VENDOR_SUBCMD_AOA_MEAS,
+	QCA_NL80211_VENDOR_SUBCMD_AOA_ABORT_MEAS,
+	QCA_NL80211_VENDOR_SUBCMD_AOA_MEAS_RESULT,
+	QCA_NL80211_VENDOR_SUBCMD_DMG_RF_GET_SECTOR_CFG,
+	QCA_NL80211_VENDOR_SUBCMD_DMG_RF_GET_SELECTED_SECTOR,
+	QCA_NL80211_VENDOR_SUBCMD_DMG_RF_SET_SELECTED_SECTOR,
+	QCA_NL80211_VENDOR_SUBCMD_GET_FW_STATE,
+	QCA_NL80211_VENDOR_SUBCMD_DISASSOC_PEER,
+};
+
+static const struct nlmon_nl_attr_table *qca_vendor_table(uint32_t subcmd)
+{
+	size_t i;
+	
+	for (i = 0; i < sizeof(qca_vendor_attr_subcmds) / sizeof(qca_vendor_attr_subcmds[0]); i++) {
+		if (qca_vendor_attr_subcmds[i] == subcmd)
+			return &qca_vendor_attr_table;
+	}
+	return NULL;
+}
+
+/**
+ * Set how deep nl80211 messages are decoded
+ */
+int nlmon_genl_set_decode_config(const struct nlmon_genl_decode_config *config)
+{
+	uint32_t mask = GENL_SLOTS_REQUIRED;
+	unsigned int i;
+	
+	if (!config) {
+		genl_depth = NLMON_GENL_DEPTH_ATTRS;
+		genl_slot_mask = GENL_SLOTS_ALL;
+		return 0;
+	}
+	
+	if (config->depth > NLMON_GENL_DEPTH_VENDOR)
+		return -EINVAL;
+	
+	if (!config->attrs) {
+		mask = GENL_SLOTS_ALL;
+	} else {
+		for (i = 0; i < config->nattrs; i++) {
+			uint16_t type = config->attrs[i];
+			
+			if (type > NL80211_ATTR_MAX || !genl_slot_of[type])
+				return -EINVAL;
+			mask |= GENL_SLOT_BIT(genl_slot_of[type]);
+		}
+	}
+	
+	genl_depth = config->depth;
+	genl_slot_mask = mask;
+	return 0;
+}
+
+/* Collect the whitelisted attributes of a message in one pass */
+static int genl_collect_attrs(struct nlmsghdr *nlh, struct nlattr **slots)
+{
+	struct genlmsghdr *gnlh = nlmsg_data(nlh);
+	uint32_t mask = genl_slot_mask;
+	struct nlattr *attr;
+	int remaining;
+	
+	memset(slots, 0, GENL_SLOT_COUNT * sizeof(*slots));
+	
+	if (!genlmsg_valid_hdr(nlh, 0))
+		return -NLE_MSG_TOOSHORT;
+	
+	nla_for_each_attr(attr, genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0), remaining) {
+		int type = nla_type(attr);
+		uint8_t slot;
+		
+		if (type > NL80211_ATTR_MAX)
+			continue;
+		
+		/* As with genlmsg_parse(), the last occurrence wins */
+		slot = genl_slot_of[type];
+		if (slot && (mask & GENL_SLOT_BIT(slot)))
+			slots[slot] = attr;
+	}
+	
+	return 0;
+}
+
+/* Read a u32 slot, ignoring attributes too short for it */
+static int genl_slot_u32(struct nlattr **slots, enum genl_slot slot, uint32_t *value)
+{
+	if (!slots[slot] || nla_len(slots[slot]) < (int)sizeof(uint32_t))
+		return 0;
+	
+	*value = nla_get_u32(slots[slot]);
+	return 1;
+}
+
 /**
  * Generic netlink message callback handler
  * 
@@ -35,8 +198,10 @@ int nlmon_genl_msg_handler(struct nl_msg *msg, void *arg)
 {
 	struct nlmon_nl_manager *mgr = (struct nlmon_nl_manager *)arg;
 	struct nlmsghdr *nlh = nlmsg_hdr(msg);
+	const struct nlmon_nl_msg_desc *desc;
 	struct genlmsghdr *gnlh;
 	struct nlmon_event evt;
+	int is_nl80211;
 	int ret = 0;
 	
 	if (!mgr || !nlh)
@@ -49,7 +214,7 @@ int nlmon_genl_msg_handler(struct nl_msg *msg, void *arg)
 	
 	/* Initialize event structure */
 	memset(&evt, 0, sizeof(evt));
-	evt.timestamp = time(NULL) * 1000000000ULL; /* Convert to nanoseconds */
+	evt.timestamp = nlmon_nl_recv_timestamp();
 	evt.netlink.protocol = NETLINK_GENERIC;
 	evt.netlink.msg_type = nlh->nlmsg_type;
 	evt.netlink.msg_flags = nlh->nlmsg_flags;
@@ -61,17 +226,36 @@ int nlmon_genl_msg_handler(struct nl_msg *msg, void *arg)
 	evt.netlink.genl_version = gnlh->version;
 	evt.netlink.genl_family_id = nlh->nlmsg_type;
 	
-	/* Determine family and route to appropriate parser */
-	if (mgr->nl80211_id > 0 && nlh->nlmsg_type == (uint16_t)mgr->nl80211_id) {
-		/* nl80211 message */
+	/* Controller notifications keep the family cache current, IDs of
+	 * removed families may be reused so the bindings start over */
+	desc = nlmon_nl_msg_lookup(NETLINK_GENERIC, nlh->nlmsg_type);
+	if (desc && (desc->subscribers & NLMON_NL_SUB_FAMILY) &&
+	    nlmon_genl_family_cache_update(nlh) > 0) {
+		mgr->nl80211_id = nlmon_genl_family_find("nl80211", NULL);
+		nlmon_nl_msg_unbind_genl();
+	}
+	
+	/* Name the family from the cache. Without one only nl80211, resolved
+	 * by name, is known. */
+	is_nl80211 = mgr->nl80211_id > 0 && nlh->nlmsg_type == (uint16_t)mgr->nl80211_id;
+	if (nlmon_genl_family_name(nlh->nlmsg_type, evt.netlink.genl_family_name,
+	                           sizeof(evt.netlink.genl_family_name)) < 0) {
+		if (!is_nl80211)
+			return NL_SKIP;
 		strncpy(evt.netlink.genl_family_name, "nl80211", 
 		        sizeof(evt.netlink.genl_family_name) - 1);
-		ret = nlmon_parse_nl80211_msg(nlh, &evt);
-		evt.event_type = nlh->nlmsg_type;
-	} else {
-		/* Unknown family - skip for now */
-		return NL_SKIP;
 	}
+	evt.event_type = nlh->nlmsg_type;
+	
+	/* First message of a family binds its ID to the family's entry */
+	if (!desc)
+		desc = nlmon_nl_msg_bind_genl(nlh->nlmsg_type, evt.netlink.genl_family_name);
+	if (!desc || !(desc->subscribers & NLMON_NL_SUB_EVENTS))
+		return NL_SKIP;
+	
+	/* Route to the family's parser, most families carry no data */
+	if (desc->parse)
+		ret = desc->parse(nlh, &evt);
 	
 	/* If parsing failed, skip this message */
 	if (ret < 0) {
@@ -81,9 +265,7 @@ int nlmon_genl_msg_handler(struct nl_msg *msg, void *arg)
 	}
 	
 	/* Forward event to nlmon event processor if callback is set */
-	if (mgr->event_callback) {
-		mgr->event_callback(&evt, mgr->user_data);
-	}
+	nlmon_nl_deliver_event(mgr, &evt);
 	
 	/* Free any allocated data in the event */
 	if (evt.netlink.data.generic) {
@@ -94,16 +276,92 @@ int nlmon_genl_msg_handler(struct nl_msg *msg, void *arg)
 	return NL_OK;
 }
 
+/**
+ * Decode a QCA vendor command from its collected attributes
+ */
+static int qca_vendor_decode(struct nlattr **slots, struct nlmon_event *evt)
+{
+	const struct nlmon_nl_attr_table *table;
+	struct nlmon_qca_vendor_info *qca_info;
+	const char *subcmd_name;
+	uint32_t vendor_id;
+	uint32_t subcmd;
+	uint32_t ifindex;
+	
+	/* Extract vendor ID */
+	if (!genl_slot_u32(slots, GENL_SLOT_VENDOR_ID, &vendor_id)) {
+		fprintf(stderr, "Missing vendor ID attribute\n");
+		return -EINVAL;
+	}
+	
+	/* Verify it's a QCA vendor command */
+	if (vendor_id != OUI_QCA) {
+		fprintf(stderr, "Not a QCA vendor command (vendor_id=0x%06x)\n", vendor_id);
+		return -EINVAL;
+	}
+	
+	/* Extract vendor subcommand */
+	if (!genl_slot_u32(slots, GENL_SLOT_VENDOR_SUBCMD, &subcmd)) {
+		fprintf(stderr, "Missing vendor subcommand attribute\n");
+		return -EINVAL;
+	}
+	
+	/* Allocate QCA vendor info structure */
+	qca_info = calloc(1, sizeof(*qca_info));
+	if (!qca_info)
+		return -ENOMEM;
+	
+	/* Store vendor ID and subcommand */
+	qca_info->vendor_id = vendor_id;
+	qca_info->subcmd = subcmd;
+	
+	/* Get subcommand name from existing qca_vendor.c function */
+	subcmd_name = qca_vendor_subcmd_to_string(subcmd);
+	if (subcmd_name) {
+		strncpy(qca_info->subcmd_name, subcmd_name, sizeof(qca_info->subcmd_name) - 1);
+	} else {
+		snprintf(qca_info->subcmd_name, sizeof(qca_info->subcmd_name), 
+		         "UNKNOWN_0x%x", subcmd);
+	}
+	
+	/* Decode vendor data with the subcommand's attribute table */
+	if (slots[GENL_SLOT_VENDOR_DATA]) {
+		struct nlattr *data = slots[GENL_SLOT_VENDOR_DATA];
+		
+		qca_info->data_len = nla_len(data);
+		table = qca_vendor_table(subcmd);
+		if (genl_depth >= NLMON_GENL_DEPTH_VENDOR && table) {
+			nlmon_nl_attrs_decode(table, nla_data(data), nla_len(data), qca_info);
+			qca_info->data_decoded = 1;
+		}
+	}
+	
+	/* Extract interface index if present */
+	if (genl_slot_u32(slots, GENL_SLOT_IFINDEX, &ifindex)) {
+		char ifname[IFNAMSIZ];
+		if (if_indextoname(ifindex, ifname)) {
+			strncpy(evt->interface, ifname, sizeof(evt->interface) - 1);
+		}
+	}
+	
+	/* Store in event */
+	evt->netlink.data.generic = qca_info;
+	
+	return 0;
+}
+
 /**
  * Parse nl80211 message
  * 
- * Extracts nl80211 command and attributes from nl80211 messages.
+ * Extracts nl80211 command and the whitelisted attributes from nl80211
+ * messages.
  */
 int nlmon_parse_nl80211_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 {
 	struct genlmsghdr *gnlh;
-	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct nlattr *slots[GENL_SLOT_COUNT];
 	struct nlmon_nl80211_info *nl80211_info;
+	uint32_t value;
 	int ret;
 	
 	if (!nlh || !evt)
@@ -114,14 +372,23 @@ int nlmon_parse_nl80211_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 	if (!gnlh)
 		return -EINVAL;
 	
-	/* Parse nl80211 attributes */
-	ret = genlmsg_parse(nlh, 0, tb, NL80211_ATTR_MAX, NULL);
-	if (ret < 0) {
-		fprintf(stderr, "Failed to parse nl80211 message attributes: %s\n",
-		        nl_geterror(ret));
-		return ret;
+	/* Collect nl80211 attributes, none at command depth */
+	if (genl_depth == NLMON_GENL_DEPTH_CMD) {
+		memset(slots, 0, sizeof(slots));
+	} else {
+		ret = genl_collect_attrs(nlh, slots);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to parse nl80211 message attributes: %s\n",
+			        nl_geterror(ret));
+			return ret;
+		}
 	}
 	
+	/* QCA vendor commands are decoded from the same attributes */
+	if (gnlh->cmd == NL80211_CMD_VENDOR &&
+	    genl_slot_u32(slots, GENL_SLOT_VENDOR_ID, &value) && value == OUI_QCA)
+		return qca_vendor_decode(slots, evt);
+	
 	/* Allocate nl80211 info structure */
 	nl80211_info = calloc(1, sizeof(*nl80211_info));
 	if (!nl80211_info)
@@ -131,57 +398,36 @@ int nlmon_parse_nl80211_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 	nl80211_info->cmd = gnlh->cmd;
 	
 	/* Extract wiphy index */
-	if (tb[NL80211_ATTR_WIPHY]) {
-		nl80211_info->wiphy = nla_get_u32(tb[NL80211_ATTR_WIPHY]);
-	} else {
-		nl80211_info->wiphy = -1;
-	}
+	nl80211_info->wiphy = -1;
+	if (genl_slot_u32(slots, GENL_SLOT_WIPHY, &value))
+		nl80211_info->wiphy = value;
 	
 	/* Extract interface index */
-	if (tb[NL80211_ATTR_IFINDEX]) {
-		nl80211_info->ifindex = nla_get_u32(tb[NL80211_ATTR_IFINDEX]);
+	nl80211_info->ifindex = -1;
+	if (genl_slot_u32(slots, GENL_SLOT_IFINDEX, &value)) {
+		nl80211_info->ifindex = value;
 		/* Get interface name from index */
 		if_indextoname(nl80211_info->ifindex, nl80211_info->ifname);
 		/* Also set in event structure */
 		strncpy(evt->interface, nl80211_info->ifname, sizeof(evt->interface) - 1);
-	} else {
-		nl80211_info->ifindex = -1;
 	}
 	
 	/* Extract interface type */
-	if (tb[NL80211_ATTR_IFTYPE]) {
-		nl80211_info->iftype = nla_get_u32(tb[NL80211_ATTR_IFTYPE]);
-	}
+	genl_slot_u32(slots, GENL_SLOT_IFTYPE, &nl80211_info->iftype);
 	
 	/* Extract MAC address */
-	if (tb[NL80211_ATTR_MAC]) {
-		int addr_len = nla_len(tb[NL80211_ATTR_MAC]);
+	if (slots[GENL_SLOT_MAC]) {
+		int addr_len = nla_len(slots[GENL_SLOT_MAC]);
 		if (addr_len <= ETH_ALEN) {
-			memcpy(nl80211_info->mac, nla_data(tb[NL80211_ATTR_MAC]), addr_len);
+			memcpy(nl80211_info->mac, nla_data(slots[GENL_SLOT_MAC]), addr_len);
 		}
 	}
 	
 	/* Extract frequency */
-	if (tb[NL80211_ATTR_WIPHY_FREQ]) {
-		nl80211_info->freq = nla_get_u32(tb[NL80211_ATTR_WIPHY_FREQ]);
-	}
+	genl_slot_u32(slots, GENL_SLOT_FREQ, &nl80211_info->freq);
 	
 	/* Extract channel type */
-	if (tb[NL80211_ATTR_WIPHY_CHANNEL_TYPE]) {
-		nl80211_info->channel_type = nla_get_u32(tb[NL80211_ATTR_WIPHY_CHANNEL_TYPE]);
-	}
-	
-	/* Check if this is a vendor command */
-	if (gnlh->cmd == NL80211_CMD_VENDOR && tb[NL80211_ATTR_VENDOR_ID]) {
-		uint32_t vendor_id = nla_get_u32(tb[NL80211_ATTR_VENDOR_ID]);
-		
-		/* If it's a QCA vendor command, parse it separately */
-		if (vendor_id == OUI_QCA) {
-			/* Free nl80211_info as we'll use QCA vendor info instead */
-			free(nl80211_info);
-			return nlmon_parse_qca_vendor_msg(nlh, evt);
-		}
-	}
+	genl_slot_u32(slots, GENL_SLOT_CHANNEL_TYPE, &nl80211_info->channel_type);
 	
 	/* Store in event */
 	evt->netlink.data.generic = nl80211_info;
@@ -197,10 +443,7 @@ int nlmon_parse_nl80211_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 int nlmon_parse_qca_vendor_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 {
 	struct genlmsghdr *gnlh;
-	struct nlattr *tb[NL80211_ATTR_MAX + 1];
-	struct nlmon_qca_vendor_info *qca_info;
-	uint32_t vendor_id;
-	uint32_t subcmd;
+	struct nlattr *slots[GENL_SLOT_COUNT];
 	int ret;
 	
 	if (!nlh || !evt)
@@ -211,8 +454,8 @@ int nlmon_parse_qca_vendor_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 	if (!gnlh)
 		return -EINVAL;
 	
-	/* Parse nl80211 attributes */
-	ret = genlmsg_parse(nlh, 0, tb, NL80211_ATTR_MAX, NULL);
+	/* Collect nl80211 attributes */
+	ret = genl_collect_attrs(nlh, slots);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to parse QCA vendor message attributes: %s\n",
 		        nl_geterror(ret));
@@ -225,74 +468,5 @@ int nlmon_parse_qca_vendor_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 		return -EINVAL;
 	}
 	
-	/* Extract vendor ID */
-	if (!tb[NL80211_ATTR_VENDOR_ID]) {
-		fprintf(stderr, "Missing vendor ID attribute\n");
-		return -EINVAL;
-	}
-	vendor_id = nla_get_u32(tb[NL80211_ATTR_VENDOR_ID]);
-	
-	/* Verify it's a QCA vendor command */
-	if (vendor_id != OUI_QCA) {
-		fprintf(stderr, "Not a QCA vendor command (vendor_id=0x%06x)\n", vendor_id);
-		return -EINVAL;
-	}
-	
-	/* Extract vendor subcommand */
-	if (!tb[NL80211_ATTR_VENDOR_SUBCMD]) {
-		fprintf(stderr, "Missing vendor subcommand attribute\n");
-		return -EINVAL;
-	}
-	subcmd = nla_get_u32(tb[NL80211_ATTR_VENDOR_SUBCMD]);
-	
-	/* Allocate QCA vendor info structure */
-	qca_info = calloc(1, sizeof(*qca_info));
-	if (!qca_info)
-		return -ENOMEM;
-	
-	/* Store vendor ID and subcommand */
-	qca_info->vendor_id = vendor_id;
-	qca_info->subcmd = subcmd;
-	
-	/* Get subcommand name from existing qca_vendor.c function */
-	const char *subcmd_name = qca_vendor_subcmd_to_string(subcmd);
-	if (subcmd_name) {
-		strncpy(qca_info->subcmd_name, subcmd_name, sizeof(qca_info->subcmd_name) - 1);
-	} else {
-		snprintf(qca_info->subcmd_name, sizeof(qca_info->subcmd_name), 
-		         "UNKNOWN_0x%x", subcmd);
-	}
-	
-	/* Parse nested vendor data if present */
-	if (tb[NL80211_ATTR_VENDOR_DATA]) {
-		/* For now, we just note that vendor data is present
-		 * Future enhancement: parse specific vendor data attributes
-		 * based on the subcommand using nla_parse_nested()
-		 */
-		int data_len = nla_len(tb[NL80211_ATTR_VENDOR_DATA]);
-		(void)data_len; /* Suppress unused warning */
-		
-		/* Example of how to parse nested attributes:
-		 * struct nlattr *vendor_tb[QCA_WLAN_VENDOR_ATTR_MAX + 1];
-		 * ret = nla_parse_nested(vendor_tb, QCA_WLAN_VENDOR_ATTR_MAX,
-		 *                        tb[NL80211_ATTR_VENDOR_DATA], NULL);
-		 * if (ret == 0) {
-		 *     // Process vendor-specific attributes
-		 * }
-		 */
-	}
-	
-	/* Extract interface index if present */
-	if (tb[NL80211_ATTR_IFINDEX]) {
-		int ifindex = nla_get_u32(tb[NL80211_ATTR_IFINDEX]);
-		char ifname[IFNAMSIZ];
-		if (if_indextoname(ifindex, ifname)) {
-			strncpy(evt->interface, ifname, sizeof(evt->interface) - 1);
-		}
-	}
-	
-	/* Store in event */
-	evt->netlink.data.generic = qca_info;
-	
-	return 0;
+	return qca_vendor_decode(slots, evt);
 }
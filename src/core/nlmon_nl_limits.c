@@ -4,6 +4,7 @@
  * - Memory usage limits
  * - Message processing rate limits
  * - Socket buffer monitoring
+ * - Receive buffer autotuning
  * - Performance metrics collection
  */
 
@@ -18,14 +19,44 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/socket.h>
 #include <pthread.h>
+#include <linux/sock_diag.h>
 
 #include "nlmon_nl_limits.h"
+#include "stats_bus.h"
+#include "memory_governor.h"
+#include "nlmon_clock.h"
 
 #define DEFAULT_MAX_MEMORY_MB 100
 #define DEFAULT_MAX_MSG_RATE 10000
 #define DEFAULT_SAMPLE_INTERVAL_SEC 1
 
+#define DEFAULT_AUTOTUNE_MAX_RCVBUF (8 * 1024 * 1024)
+#define DEFAULT_AUTOTUNE_GROW_OCCUPANCY 50.0
+#define DEFAULT_AUTOTUNE_GROW_LOAD 0.8
+#define DEFAULT_AUTOTUNE_IDLE_SAMPLES 30
+
+#define AUTOTUNE_MAX_SOCKETS 8
+#define AUTOTUNE_HISTORY 8
+
+#ifndef SO_MEMINFO
+#define SO_MEMINFO 55
+#endif
+
+/* Per-socket autotuning state */
+struct autotune_socket {
+	int fd;                          /* -1 if slot unused */
+	size_t initial_rcvbuf;           /* Size when first seen, default floor */
+	size_t rcvbuf;                   /* Current requested size */
+	uint64_t last_sample_ns;
+	uint64_t messages;               /* Messages read from this socket */
+	uint64_t processing_ns;          /* Time spent processing them */
+	uint64_t last_messages;          /* messages at last sample */
+	uint64_t last_processing_ns;     /* processing_ns at last sample */
+	unsigned int idle;               /* Consecutive idle samples */
+};
+
 /* Resource limits structure */
 struct nlmon_nl_limits {
 	/* Memory limits */
@@ -61,16 +92,40 @@ struct nlmon_nl_limits {
 	bool memory_limit_enabled;
 	bool rate_limit_enabled;
 	
+	/* Receive buffer autotuning */
+	struct nlmon_nl_autotune_config autotune;
+	struct autotune_socket autotune_sockets[AUTOTUNE_MAX_SOCKETS];
+	struct nlmon_nl_autotune_event autotune_history[AUTOTUNE_HISTORY];
+	uint64_t autotune_adjustments;   /* Total, also history write index */
+	uint64_t autotune_grows;
+	uint64_t autotune_shrinks;
+	uint64_t autotune_force_denied;  /* SO_RCVBUFFORCE lacked CAP_NET_ADMIN */
+	size_t pressure_rcvbuf;          /* Ceiling under memory pressure, 0 for none */
+	
 	/* Thread safety */
 	pthread_mutex_t lock;
 };
 
+/**
+ * Default autotuning parameters (disabled)
+ */
+static void autotune_defaults(struct nlmon_nl_autotune_config *config)
+{
+	config->enabled = false;
+	config->min_rcvbuf = 0;    /* Socket's initial size */
+	config->max_rcvbuf = DEFAULT_AUTOTUNE_MAX_RCVBUF;
+	config->grow_occupancy = DEFAULT_AUTOTUNE_GROW_OCCUPANCY;
+	config->grow_load = DEFAULT_AUTOTUNE_GROW_LOAD;
+	config->idle_samples = DEFAULT_AUTOTUNE_IDLE_SAMPLES;
+}
+
 /**
  * Create resource limits tracker
  */
 struct nlmon_nl_limits *nlmon_nl_limits_create(void)
 {
 	struct nlmon_nl_limits *limits;
+	int i;
 	
 	limits = calloc(1, sizeof(*limits));
 	if (!limits)
@@ -85,7 +140,7 @@ struct nlmon_nl_limits *nlmon_nl_limits_create(void)
 	limits->current_memory_bytes = 0;
 	limits->peak_memory_bytes = 0;
 	limits->messages_this_second = 0;
-	limits->current_second = time(NULL);
+	limits->current_second = nlmon_clock_seconds();
 	limits->total_messages_processed = 0;
 	limits->total_messages_dropped = 0;
 	limits->total_bytes_processed = 0;
@@ -95,12 +150,17 @@ struct nlmon_nl_limits *nlmon_nl_limits_create(void)
 	limits->total_processing_time_ns = 0;
 	limits->min_processing_time_ns = UINT64_MAX;
 	limits->max_processing_time_ns = 0;
-	limits->last_sample_time = time(NULL);
+	limits->last_sample_time = nlmon_clock_seconds();
 	
 	/* Enable limits by default */
 	limits->memory_limit_enabled = true;
 	limits->rate_limit_enabled = true;
 	
+	/* Autotuning is opt-in */
+	autotune_defaults(&limits->autotune);
+	for (i = 0; i < AUTOTUNE_MAX_SOCKETS; i++)
+		limits->autotune_sockets[i].fd = -1;
+	
 	pthread_mutex_init(&limits->lock, NULL);
 	
 	return limits;
@@ -234,7 +294,7 @@ bool nlmon_nl_limits_can_process(struct nlmon_nl_limits *limits)
 	pthread_mutex_lock(&limits->lock);
 	
 	if (limits->rate_limit_enabled) {
-		now = time(NULL);
+		now = nlmon_clock_seconds();
 		
 		/* Reset counter if we're in a new second */
 		if (now != limits->current_second) {
@@ -303,6 +363,286 @@ void nlmon_nl_limits_update_socket_buffer(struct nlmon_nl_limits *limits,
 	pthread_mutex_unlock(&limits->lock);
 }
 
+static struct autotune_socket *autotune_slot(struct nlmon_nl_limits *limits, int fd);
+
+/**
+ * Record a batch of received messages
+ */
+void nlmon_nl_limits_record_batch(struct nlmon_nl_limits *limits,
+                                  int fd,
+                                  size_t messages,
+                                  size_t bytes,
+                                  uint64_t processing_time_ns)
+{
+	uint64_t per_msg_ns;
+	
+	if (!limits || messages == 0)
+		return;
+	
+	per_msg_ns = processing_time_ns / messages;
+	
+	pthread_mutex_lock(&limits->lock);
+	
+	limits->messages_this_second += messages;
+	limits->total_messages_processed += messages;
+	limits->total_bytes_processed += bytes;
+	
+	limits->total_processing_time_ns += processing_time_ns;
+	if (per_msg_ns < limits->min_processing_time_ns)
+		limits->min_processing_time_ns = per_msg_ns;
+	if (per_msg_ns > limits->max_processing_time_ns)
+		limits->max_processing_time_ns = per_msg_ns;
+	
+	/* Each socket is tuned on its own traffic */
+	if (fd >= 0) {
+		struct autotune_socket *sock = autotune_slot(limits, fd);
+	
+		if (sock) {
+			sock->messages += messages;
+			sock->processing_ns += processing_time_ns;
+		}
+	}
+	
+	pthread_mutex_unlock(&limits->lock);
+}
+
+/**
+ * Configure receive buffer autotuning
+ */
+void nlmon_nl_limits_set_autotune(struct nlmon_nl_limits *limits,
+                                  const struct nlmon_nl_autotune_config *config)
+{
+	if (!limits)
+		return;
+	
+	pthread_mutex_lock(&limits->lock);
+	
+	if (!config) {
+		autotune_defaults(&limits->autotune);
+		pthread_mutex_unlock(&limits->lock);
+		return;
+	}
+	
+	limits->autotune = *config;
+	if (limits->autotune.max_rcvbuf == 0)
+		limits->autotune.max_rcvbuf = DEFAULT_AUTOTUNE_MAX_RCVBUF;
+	if (limits->autotune.grow_occupancy <= 0.0)
+		limits->autotune.grow_occupancy = DEFAULT_AUTOTUNE_GROW_OCCUPANCY;
+	if (limits->autotune.grow_load <= 0.0)
+		limits->autotune.grow_load = DEFAULT_AUTOTUNE_GROW_LOAD;
+	if (limits->autotune.idle_samples == 0)
+		limits->autotune.idle_samples = DEFAULT_AUTOTUNE_IDLE_SAMPLES;
+	pthread_mutex_unlock(&limits->lock);
+}
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Requested receive buffer size (the kernel reports twice the value set) */
+static size_t socket_get_rcvbuf(int fd)
+{
+	int val = 0;
+	socklen_t len = sizeof(val);
+	
+	if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &val, &len) < 0 || val <= 0)
+		return 0;
+	
+	return (size_t)val / 2;
+}
+
+/* Bytes queued for reading; netlink has no SIOCINQ, use SO_MEMINFO */
+static size_t socket_get_queued(int fd)
+{
+	uint32_t meminfo[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(meminfo);
+	
+	if (getsockopt(fd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) < 0 ||
+	    len < sizeof(uint32_t) * (SK_MEMINFO_RMEM_ALLOC + 1))
+		return 0;
+	
+	return meminfo[SK_MEMINFO_RMEM_ALLOC];
+}
+
+/* Apply a new size, returns the effective size */
+static size_t socket_set_rcvbuf(struct nlmon_nl_limits *limits, int fd,
+                                size_t size, bool *forced)
+{
+	int val = (int)size;
+	
+	*forced = true;
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &val, sizeof(val)) < 0) {
+		/* Without CAP_NET_ADMIN the kernel caps this at rmem_max */
+		*forced = false;
+		limits->autotune_force_denied++;
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val));
+	}
+	
+	return socket_get_rcvbuf(fd);
+}
+
+static struct autotune_socket *autotune_slot(struct nlmon_nl_limits *limits, int fd)
+{
+	struct autotune_socket *free_slot = NULL;
+	int i;
+	
+	for (i = 0; i < AUTOTUNE_MAX_SOCKETS; i++) {
+		if (limits->autotune_sockets[i].fd == fd)
+			return &limits->autotune_sockets[i];
+		if (!free_slot && limits->autotune_sockets[i].fd < 0)
+			free_slot = &limits->autotune_sockets[i];
+	}
+	
+	if (free_slot) {
+		memset(free_slot, 0, sizeof(*free_slot));
+		free_slot->fd = fd;
+		free_slot->rcvbuf = free_slot->initial_rcvbuf = socket_get_rcvbuf(fd);
+		free_slot->last_sample_ns = monotonic_ns();
+	}
+	
+	return free_slot;
+}
+
+/**
+ * Run one autotuning step for a socket
+ */
+ssize_t nlmon_nl_limits_autotune(struct nlmon_nl_limits *limits, int fd, bool overrun)
+{
+	struct nlmon_nl_autotune_event *ev;
+	struct autotune_socket *sock;
+	enum nlmon_nl_autotune_reason reason;
+	uint64_t now, elapsed_ns, messages, busy_ns;
+	size_t queued, floor, ceiling, target, old_size, new_size;
+	double occupancy, load;
+	bool forced;
+	ssize_t ret = 0;
+	
+	if (!limits || fd < 0)
+		return -EINVAL;
+	
+	pthread_mutex_lock(&limits->lock);
+	
+	sock = autotune_slot(limits, fd);
+	if (!sock) {
+		pthread_mutex_unlock(&limits->lock);
+		return -ENOSPC;
+	}
+	
+	if (overrun)
+		limits->socket_buffer_drops++;
+	
+	now = monotonic_ns();
+	elapsed_ns = now - sock->last_sample_ns;
+	if (!overrun && elapsed_ns < limits->sample_interval_sec * 1000000000ULL) {
+		pthread_mutex_unlock(&limits->lock);
+		return 0;
+	}
+	
+	/* Sample queue occupancy and how busy the drain side was */
+	queued = socket_get_queued(fd);
+	occupancy = sock->rcvbuf > 0 ? (double)queued / sock->rcvbuf * 100.0 : 0.0;
+	messages = sock->messages - sock->last_messages;
+	busy_ns = sock->processing_ns - sock->last_processing_ns;
+	load = elapsed_ns > 0 ? (double)busy_ns / elapsed_ns : 0.0;
+	
+	sock->last_sample_ns = now;
+	sock->last_messages = sock->messages;
+	sock->last_processing_ns = sock->processing_ns;
+	
+	limits->socket_buffer_size = sock->rcvbuf;
+	limits->socket_buffer_used = queued;
+	
+	if (!limits->autotune.enabled)
+		goto out;
+	
+	floor = limits->autotune.min_rcvbuf ? limits->autotune.min_rcvbuf : sock->initial_rcvbuf;
+	old_size = sock->rcvbuf;
+	target = old_size;
+	
+	/* Memory pressure lowers the ceiling, down to the floor at most */
+	ceiling = limits->autotune.max_rcvbuf;
+	if (limits->pressure_rcvbuf && limits->pressure_rcvbuf < ceiling)
+		ceiling = limits->pressure_rcvbuf > floor ? limits->pressure_rcvbuf : floor;
+	
+	if (old_size > ceiling) {
+		reason = NLMON_NL_AUTOTUNE_PRESSURE;
+		sock->idle = 0;
+		target = ceiling;
+	} else if (overrun || occupancy >= limits->autotune.grow_occupancy ||
+	    load >= limits->autotune.grow_load) {
+		reason = overrun ? NLMON_NL_AUTOTUNE_OVERRUN :
+		         occupancy >= limits->autotune.grow_occupancy ?
+		         NLMON_NL_AUTOTUNE_OCCUPANCY : NLMON_NL_AUTOTUNE_LOAD;
+		sock->idle = 0;
+		target = old_size * 2;
+		if (target > ceiling)
+			target = ceiling;
+	} else if (messages == 0 && queued == 0) {
+		reason = NLMON_NL_AUTOTUNE_IDLE;
+		if (++sock->idle >= limits->autotune.idle_samples) {
+			sock->idle = 0;
+			target = old_size / 2;
+			if (target < floor)
+				target = floor;
+		}
+	} else {
+		sock->idle = 0;
+		goto out;
+	}
+	
+	if (target == old_size)
+		goto out;
+	
+	new_size = socket_set_rcvbuf(limits, fd, target, &forced);
+	if (new_size == 0 || new_size == old_size)
+		goto out;
+	
+	sock->rcvbuf = new_size;
+	limits->socket_buffer_size = new_size;
+	
+	if (new_size > old_size)
+		limits->autotune_grows++;
+	else
+		limits->autotune_shrinks++;
+	
+	ev = &limits->autotune_history[limits->autotune_adjustments % AUTOTUNE_HISTORY];
+	ev->timestamp = nlmon_clock_seconds();
+	ev->fd = fd;
+	ev->old_size = old_size;
+	ev->new_size = new_size;
+	ev->reason = reason;
+	ev->forced = forced;
+	limits->autotune_adjustments++;
+	
+	ret = (ssize_t)new_size;
+	
+out:
+	pthread_mutex_unlock(&limits->lock);
+	return ret;
+}
+
+/**
+ * Drop autotuning state for a socket
+ */
+void nlmon_nl_limits_forget_socket(struct nlmon_nl_limits *limits, int fd)
+{
+	int i;
+	
+	if (!limits)
+		return;
+	
+	pthread_mutex_lock(&limits->lock);
+	for (i = 0; i < AUTOTUNE_MAX_SOCKETS; i++) {
+		if (limits->autotune_sockets[i].fd == fd)
+			limits->autotune_sockets[i].fd = -1;
+	}
+	pthread_mutex_unlock(&limits->lock);
+}
+
 /**
  * Get resource statistics
  */
@@ -350,6 +690,18 @@ void nlmon_nl_limits_get_stats(struct nlmon_nl_limits *limits,
 	pthread_mutex_unlock(&limits->lock);
 }
 
+/**
+ * Stats bus collector
+ */
+void nlmon_nl_limits_collect_stats(struct nlmon_stats_snapshot *snapshot, void *ctx)
+{
+	if (!ctx)
+		return;
+	
+	nlmon_nl_limits_get_stats(ctx, &snapshot->netlink);
+	snapshot->have |= STATS_HAVE_NETLINK;
+}
+
 /**
  * Reset statistics
  */
@@ -445,8 +797,17 @@ ssize_t nlmon_nl_limits_export_json(struct nlmon_nl_limits *limits,
                                     char *buffer,
                                     size_t buffer_size)
 {
+	static const char *reason_names[] = {
+		[NLMON_NL_AUTOTUNE_OVERRUN] = "overrun",
+		[NLMON_NL_AUTOTUNE_OCCUPANCY] = "occupancy",
+		[NLMON_NL_AUTOTUNE_LOAD] = "load",
+		[NLMON_NL_AUTOTUNE_IDLE] = "idle",
+		[NLMON_NL_AUTOTUNE_PRESSURE] = "pressure",
+	};
 	struct nlmon_nl_resource_stats stats;
 	size_t offset = 0;
+	uint64_t first, i;
+	int n;
 	
 	if (!limits || !buffer || buffer_size == 0)
 		return -1;
@@ -458,7 +819,7 @@ ssize_t nlmon_nl_limits_export_json(struct nlmon_nl_limits *limits,
 	                  "\"messages\":{\"processed\":%lu,\"dropped\":%lu,\"bytes\":%lu,"
 	                  "\"per_sec\":%zu,\"max_per_sec\":%zu,\"drop_rate\":%.2f},"
 	                  "\"socket_buffer\":{\"size\":%zu,\"used\":%zu,\"drops\":%zu,\"utilization\":%.2f},"
-	                  "\"processing_time\":{\"avg_ns\":%lu,\"min_ns\":%lu,\"max_ns\":%lu}}",
+	                  "\"processing_time\":{\"avg_ns\":%lu,\"min_ns\":%lu,\"max_ns\":%lu},",
 	                  stats.current_memory_bytes, stats.peak_memory_bytes, stats.max_memory_bytes,
 	                  stats.memory_utilization,
 	                  stats.total_messages_processed, stats.total_messages_dropped,
@@ -468,6 +829,41 @@ ssize_t nlmon_nl_limits_export_json(struct nlmon_nl_limits *limits,
 	                  stats.socket_buffer_drops, stats.socket_buffer_utilization,
 	                  stats.avg_processing_time_ns, stats.min_processing_time_ns,
 	                  stats.max_processing_time_ns);
+	if (offset >= buffer_size)
+		return -1;
+	
+	/* Receive buffer adjustments, oldest first */
+	pthread_mutex_lock(&limits->lock);
+	
+	n = snprintf(buffer + offset, buffer_size - offset,
+	             "\"autotune\":{\"enabled\":%s,\"adjustments\":%lu,\"grows\":%lu,"
+	             "\"shrinks\":%lu,\"force_denied\":%lu,\"history\":[",
+	             limits->autotune.enabled ? "true" : "false",
+	             limits->autotune_adjustments, limits->autotune_grows,
+	             limits->autotune_shrinks, limits->autotune_force_denied);
+	offset += n;
+	
+	first = limits->autotune_adjustments > AUTOTUNE_HISTORY ?
+	        limits->autotune_adjustments - AUTOTUNE_HISTORY : 0;
+	for (i = first; i < limits->autotune_adjustments && offset < buffer_size; i++) {
+		const struct nlmon_nl_autotune_event *ev =
+			&limits->autotune_history[i % AUTOTUNE_HISTORY];
+		
+		n = snprintf(buffer + offset, buffer_size - offset,
+		             "%s{\"time\":%ld,\"fd\":%d,\"old\":%zu,\"new\":%zu,"
+		             "\"reason\":\"%s\",\"forced\":%s}",
+		             i > first ? "," : "", (long)ev->timestamp, ev->fd,
+		             ev->old_size, ev->new_size, reason_names[ev->reason],
+		             ev->forced ? "true" : "false");
+		offset += n;
+	}
+	
+	pthread_mutex_unlock(&limits->lock);
+	
+	if (offset < buffer_size)
+		offset += snprintf(buffer + offset, buffer_size - offset, "]}}");
+	if (offset >= buffer_size)
+		return -1;
 	
 	return offset;
 }
@@ -506,3 +902,53 @@ size_t nlmon_nl_limits_get_message_rate(struct nlmon_nl_limits *limits)
 	return rate;
 }
 
+/**
+ * Memory governor usage report
+ */
+size_t nlmon_nl_limits_memory_usage(void *ctx)
+{
+	struct nlmon_nl_limits *limits = ctx;
+	size_t usage;
+	int i;
+	
+	if (!limits)
+		return 0;
+	
+	pthread_mutex_lock(&limits->lock);
+	
+	/* A burst may fill every buffer, with the kernel's overhead on top */
+	usage = limits->current_memory_bytes;
+	for (i = 0; i < AUTOTUNE_MAX_SOCKETS; i++)
+		if (limits->autotune_sockets[i].fd >= 0)
+			usage += limits->autotune_sockets[i].rcvbuf * 2;
+	
+	pthread_mutex_unlock(&limits->lock);
+	
+	return usage;
+}
+
+/**
+ * Memory governor pressure response
+ */
+void nlmon_nl_limits_memory_respond(void *ctx, enum memory_pressure level, size_t target)
+{
+	struct nlmon_nl_limits *limits = ctx;
+	size_t sockets = 0;
+	int i;
+	
+	if (!limits)
+		return;
+	
+	pthread_mutex_lock(&limits->lock);
+	
+	if (level < MEMORY_PRESSURE_HIGH || target == 0) {
+		limits->pressure_rcvbuf = 0;
+	} else {
+		for (i = 0; i < AUTOTUNE_MAX_SOCKETS; i++)
+			if (limits->autotune_sockets[i].fd >= 0)
+				sockets++;
+		limits->pressure_rcvbuf = target / 2 / (sockets ? sockets : 1);
+	}
+	
+	pthread_mutex_unlock(&limits->lock);
+}
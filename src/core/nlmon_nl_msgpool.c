@@ -2,6 +2,12 @@
  *
  * Implements a memory pool for netlink message buffers to reduce
  * allocation overhead in hot paths.
+ *
+ * Buffers come in power of two size classes, each class one slab with a
+ * lock-free free list. The free lists are Treiber stacks of buffer
+ * indexes whose head carries a tag against ABA, and a buffer's class and
+ * index follow from its address, so no path takes a lock. Large slabs
+ * are huge page backed, see huge_alloc.h.
  */
 
 #ifndef _GNU_SOURCE
@@ -12,44 +18,176 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
-#include <pthread.h>
+#include <stdatomic.h>
 
 #include "nlmon_nl_msgpool.h"
+#include "huge_alloc.h"
 
 #define DEFAULT_POOL_SIZE 256
 #define DEFAULT_MSG_SIZE 4096
 #define MAX_MSG_SIZE 65536
 
-/* Message buffer structure */
-struct msg_buffer {
-	void *data;
-	size_t size;
-	size_t capacity;
-	bool in_use;
-	struct msg_buffer *next;
+/* Smallest class, NLMON_MSGPOOL_CLASSES classes double up to MAX_MSG_SIZE */
+#define MIN_CLASS_SHIFT 9
+
+/* Fewest buffers in a class */
+#define MIN_CLASS_BUFFERS 4
+
+/* Larger classes an allocation may fall back to when its own is empty */
+#define SPILL_CLASSES 2
+
+/* End of a free list */
+#define FREE_NIL UINT32_MAX
+
+/* Size class - slab of equal buffers */
+struct msg_class {
+	char *slab;
+	size_t buffer_size;
+	size_t count;
+	_Atomic uint32_t *next;       /* Free list links by buffer index */
+	atomic_bool *in_use;
+	atomic_ullong free_head;      /* Tag in the upper, head index in the lower half */
+	atomic_size_t allocated;
+	atomic_size_t hits;
+	atomic_size_t misses;         /* Requests of this class not served by it */
 };
 
 /* Message pool structure */
 struct nlmon_nl_msgpool {
-	struct msg_buffer *buffers;
-	struct msg_buffer *free_list;
+	struct msg_class classes[NLMON_MSGPOOL_CLASSES];
 	size_t pool_size;
 	size_t buffer_size;
-	size_t allocated_count;
-	size_t free_count;
-	size_t alloc_requests;
-	size_t pool_hits;
-	size_t pool_misses;
-	pthread_mutex_t lock;
+	atomic_size_t alloc_requests;
+	atomic_size_t pool_hits;
+	atomic_size_t pool_misses;
 };
 
+/* Smallest class holding size bytes, NLMON_MSGPOOL_CLASSES if none */
+static int msg_class_index(size_t size)
+{
+	int c = 0;
+	
+	while (c < NLMON_MSGPOOL_CLASSES && ((size_t)1 << (MIN_CLASS_SHIFT + c)) < size)
+		c++;
+	
+	return c;
+}
+
+/* Class a pointer belongs to, sets *index to its buffer */
+static struct msg_class *msg_class_find(struct nlmon_nl_msgpool *pool, void *ptr,
+                                        uint32_t *index)
+{
+	struct msg_class *cls;
+	size_t offset;
+	int c;
+	
+	for (c = 0; c < NLMON_MSGPOOL_CLASSES; c++) {
+		cls = &pool->classes[c];
+		if ((char *)ptr < cls->slab ||
+		    (char *)ptr >= cls->slab + cls->count * cls->buffer_size)
+			continue;
+		
+		offset = (size_t)((char *)ptr - cls->slab);
+		if (offset % cls->buffer_size)
+			return NULL;
+		
+		*index = (uint32_t)(offset / cls->buffer_size);
+		return cls;
+	}
+	
+	return NULL;
+}
+
+static void msg_class_push(struct msg_class *cls, uint32_t index)
+{
+	uint64_t old, new;
+	
+	old = atomic_load_explicit(&cls->free_head, memory_order_relaxed);
+	do {
+		atomic_store_explicit(&cls->next[index], (uint32_t)old, memory_order_relaxed);
+		new = (((old >> 32) + 1) << 32) | index;
+	} while (!atomic_compare_exchange_weak_explicit(&cls->free_head, &old, new,
+	                                                memory_order_release,
+	                                                memory_order_relaxed));
+}
+
+static uint32_t msg_class_pop(struct msg_class *cls)
+{
+	uint64_t old, new;
+	uint32_t index;
+	
+	old = atomic_load_explicit(&cls->free_head, memory_order_acquire);
+	do {
+		index = (uint32_t)old;
+		if (index == FREE_NIL)
+			return FREE_NIL;
+		
+		new = (((old >> 32) + 1) << 32) |
+		      atomic_load_explicit(&cls->next[index], memory_order_relaxed);
+	} while (!atomic_compare_exchange_weak_explicit(&cls->free_head, &old, new,
+	                                                memory_order_acquire,
+	                                                memory_order_acquire));
+	
+	return index;
+}
+
+/* Take a buffer from one class, NULL if it is empty */
+static void *msg_class_alloc(struct msg_class *cls)
+{
+	uint32_t index;
+	
+	index = msg_class_pop(cls);
+	if (index == FREE_NIL)
+		return NULL;
+	
+	atomic_store_explicit(&cls->in_use[index], true, memory_order_relaxed);
+	atomic_fetch_add_explicit(&cls->allocated, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&cls->hits, 1, memory_order_relaxed);
+	
+	return cls->slab + (size_t)index * cls->buffer_size;
+}
+
+static void msg_class_destroy(struct msg_class *cls)
+{
+	huge_free(cls->slab);
+	free(cls->next);
+	free(cls->in_use);
+}
+
+static int msg_class_init(struct msg_class *cls, size_t buffer_size, size_t count)
+{
+	size_t i;
+	
+	cls->buffer_size = buffer_size;
+	cls->count = count;
+	cls->slab = huge_calloc(count, buffer_size, 0, "nl_msgpool");
+	cls->next = calloc(count, sizeof(*cls->next));
+	cls->in_use = calloc(count, sizeof(*cls->in_use));
+	if (!cls->slab || !cls->next || !cls->in_use) {
+		msg_class_destroy(cls);
+		return -ENOMEM;
+	}
+	
+	/* Build the free list, lowest addresses first */
+	atomic_init(&cls->free_head, FREE_NIL);
+	for (i = count; i > 0; i--)
+		msg_class_push(cls, (uint32_t)(i - 1));
+	
+	atomic_init(&cls->allocated, 0);
+	atomic_init(&cls->hits, 0);
+	atomic_init(&cls->misses, 0);
+	
+	return 0;
+}
+
 /**
  * Create message pool
  */
 struct nlmon_nl_msgpool *nlmon_nl_msgpool_create(size_t pool_size, size_t buffer_size)
 {
 	struct nlmon_nl_msgpool *pool;
-	size_t i;
+	size_t count;
+	int c, base;
 	
 	if (pool_size == 0)
 		pool_size = DEFAULT_POOL_SIZE;
@@ -62,46 +200,33 @@ struct nlmon_nl_msgpool *nlmon_nl_msgpool_create(size_t pool_size, size_t buffer
 	if (!pool)
 		return NULL;
 	
-	pool->buffers = calloc(pool_size, sizeof(struct msg_buffer));
-	if (!pool->buffers) {
-		free(pool);
-		return NULL;
-	}
-	
-	pool->pool_size = pool_size;
 	pool->buffer_size = buffer_size;
-	pool->allocated_count = 0;
-	pool->free_count = pool_size;
-	pool->alloc_requests = 0;
-	pool->pool_hits = 0;
-	pool->pool_misses = 0;
-	
-	/* Initialize buffers and build free list */
-	pool->free_list = NULL;
-	for (i = 0; i < pool_size; i++) {
-		struct msg_buffer *buf = &pool->buffers[i];
+	
+	/*
+	 * Classes up to buffer_size get pool_size buffers each, larger
+	 * ones half as many per step since big dumps are rarer.
+	 */
+	base = msg_class_index(buffer_size);
+	for (c = 0; c < NLMON_MSGPOOL_CLASSES; c++) {
+		count = c <= base ? pool_size : pool_size >> (c - base);
+		if (count < MIN_CLASS_BUFFERS)
+			count = MIN_CLASS_BUFFERS;
 		
-		buf->data = malloc(buffer_size);
-		if (!buf->data) {
+		if (msg_class_init(&pool->classes[c], (size_t)1 << (MIN_CLASS_SHIFT + c),
+		                   count) < 0) {
 			/* Cleanup on failure */
-			for (size_t j = 0; j < i; j++) {
-				free(pool->buffers[j].data);
-			}
-			free(pool->buffers);
+			while (--c >= 0)
+				msg_class_destroy(&pool->classes[c]);
 			free(pool);
 			return NULL;
 		}
 		
-		buf->size = 0;
-		buf->capacity = buffer_size;
-		buf->in_use = false;
-		
-		/* Add to free list */
-		buf->next = pool->free_list;
-		pool->free_list = buf;
+		pool->pool_size += count;
 	}
 	
-	pthread_mutex_init(&pool->lock, NULL);
+	atomic_init(&pool->alloc_requests, 0);
+	atomic_init(&pool->pool_hits, 0);
+	atomic_init(&pool->pool_misses, 0);
 	
 	return pool;
 }
@@ -111,19 +236,14 @@ struct nlmon_nl_msgpool *nlmon_nl_msgpool_create(size_t pool_size, size_t buffer
  */
 void nlmon_nl_msgpool_destroy(struct nlmon_nl_msgpool *pool)
 {
-	size_t i;
+	int c;
 	
 	if (!pool)
 		return;
 	
-	if (pool->buffers) {
-		for (i = 0; i < pool->pool_size; i++) {
-			free(pool->buffers[i].data);
-		}
-		free(pool->buffers);
-	}
+	for (c = 0; c < NLMON_MSGPOOL_CLASSES; c++)
+		msg_class_destroy(&pool->classes[c]);
 	
-	pthread_mutex_destroy(&pool->lock);
 	free(pool);
 }
 
@@ -132,46 +252,32 @@ void nlmon_nl_msgpool_destroy(struct nlmon_nl_msgpool *pool)
  */
 void *nlmon_nl_msgpool_alloc(struct nlmon_nl_msgpool *pool, size_t size)
 {
-	struct msg_buffer *buf;
 	void *data = NULL;
+	int c, first;
 	
 	if (!pool)
 		return NULL;
 	
-	pthread_mutex_lock(&pool->lock);
-	
-	pool->alloc_requests++;
+	atomic_fetch_add_explicit(&pool->alloc_requests, 1, memory_order_relaxed);
 	
-	/* Check if requested size fits in pool buffers */
-	if (size > pool->buffer_size) {
-		/* Size too large for pool, allocate directly */
-		pthread_mutex_unlock(&pool->lock);
-		pool->pool_misses++;
-		return malloc(size);
+	/* Own class first, then a few larger ones before the heap */
+	first = msg_class_index(size);
+	for (c = first; c < NLMON_MSGPOOL_CLASSES && c <= first + SPILL_CLASSES; c++) {
+		data = msg_class_alloc(&pool->classes[c]);
+		if (data)
+			break;
 	}
 	
-	/* Try to get buffer from free list */
-	if (pool->free_list) {
-		buf = pool->free_list;
-		pool->free_list = buf->next;
-		buf->next = NULL;
-		buf->in_use = true;
-		buf->size = size;
-		
-		pool->free_count--;
-		pool->allocated_count++;
-		pool->pool_hits++;
-		
-		data = buf->data;
-	} else {
-		/* Pool exhausted, allocate directly */
-		pool->pool_misses++;
-		data = malloc(size);
+	if (data) {
+		atomic_fetch_add_explicit(&pool->pool_hits, 1, memory_order_relaxed);
+		return data;
 	}
 	
-	pthread_mutex_unlock(&pool->lock);
-	
-	return data;
+	/* Size too large or classes exhausted, allocate directly */
+	if (first < NLMON_MSGPOOL_CLASSES)
+		atomic_fetch_add_explicit(&pool->classes[first].misses, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&pool->pool_misses, 1, memory_order_relaxed);
+	return malloc(size);
 }
 
 /**
@@ -179,39 +285,26 @@ void *nlmon_nl_msgpool_alloc(struct nlmon_nl_msgpool *pool, size_t size)
  */
 void nlmon_nl_msgpool_free(struct nlmon_nl_msgpool *pool, void *ptr)
 {
-	struct msg_buffer *buf;
-	size_t i;
-	bool found = false;
+	struct msg_class *cls;
+	uint32_t index;
 	
 	if (!pool || !ptr)
 		return;
 	
-	pthread_mutex_lock(&pool->lock);
-	
-	/* Check if this buffer belongs to the pool */
-	for (i = 0; i < pool->pool_size; i++) {
-		buf = &pool->buffers[i];
-		if (buf->data == ptr && buf->in_use) {
-			/* Return to free list */
-			buf->in_use = false;
-			buf->size = 0;
-			buf->next = pool->free_list;
-			pool->free_list = buf;
-			
-			pool->free_count++;
-			pool->allocated_count--;
-			
-			found = true;
-			break;
-		}
-	}
-	
-	pthread_mutex_unlock(&pool->lock);
+	cls = msg_class_find(pool, ptr, &index);
 	
 	/* If not from pool, free directly */
-	if (!found) {
+	if (!cls) {
 		free(ptr);
+		return;
 	}
+	
+	/* Ignore a buffer that is not handed out */
+	if (!atomic_exchange_explicit(&cls->in_use[index], false, memory_order_relaxed))
+		return;
+	
+	atomic_fetch_sub_explicit(&cls->allocated, 1, memory_order_relaxed);
+	msg_class_push(cls, index);
 }
 
 /**
@@ -220,26 +313,55 @@ void nlmon_nl_msgpool_free(struct nlmon_nl_msgpool *pool, void *ptr)
 void nlmon_nl_msgpool_get_stats(struct nlmon_nl_msgpool *pool,
                                 struct nlmon_msgpool_stats *stats)
 {
+	size_t allocated = 0;
+	int c;
+	
 	if (!pool || !stats)
 		return;
 	
-	pthread_mutex_lock(&pool->lock);
+	for (c = 0; c < NLMON_MSGPOOL_CLASSES; c++)
+		allocated += atomic_load_explicit(&pool->classes[c].allocated,
+		                                  memory_order_relaxed);
 	
 	stats->pool_size = pool->pool_size;
 	stats->buffer_size = pool->buffer_size;
-	stats->allocated_count = pool->allocated_count;
-	stats->free_count = pool->free_count;
-	stats->alloc_requests = pool->alloc_requests;
-	stats->pool_hits = pool->pool_hits;
-	stats->pool_misses = pool->pool_misses;
-	
-	if (pool->alloc_requests > 0) {
-		stats->hit_rate = (double)pool->pool_hits / pool->alloc_requests * 100.0;
+	stats->allocated_count = allocated;
+	stats->free_count = pool->pool_size - allocated;
+	stats->alloc_requests = atomic_load_explicit(&pool->alloc_requests, memory_order_relaxed);
+	stats->pool_hits = atomic_load_explicit(&pool->pool_hits, memory_order_relaxed);
+	stats->pool_misses = atomic_load_explicit(&pool->pool_misses, memory_order_relaxed);
+	
+	if (stats->alloc_requests > 0) {
+		stats->hit_rate = (double)stats->pool_hits / stats->alloc_requests * 100.0;
 	} else {
 		stats->hit_rate = 0.0;
 	}
+}
+
+/**
+ * Get per size class statistics
+ */
+size_t nlmon_nl_msgpool_get_class_stats(struct nlmon_nl_msgpool *pool,
+                                        struct nlmon_msgpool_class_stats *stats,
+                                        size_t max)
+{
+	struct msg_class *cls;
+	size_t c;
+	
+	if (!pool)
+		return 0;
+	
+	for (c = 0; c < NLMON_MSGPOOL_CLASSES && c < max && stats; c++) {
+		cls = &pool->classes[c];
+		stats[c].buffer_size = cls->buffer_size;
+		stats[c].buffer_count = cls->count;
+		stats[c].allocated_count = atomic_load_explicit(&cls->allocated,
+		                                                memory_order_relaxed);
+		stats[c].hits = atomic_load_explicit(&cls->hits, memory_order_relaxed);
+		stats[c].misses = atomic_load_explicit(&cls->misses, memory_order_relaxed);
+	}
 	
-	pthread_mutex_unlock(&pool->lock);
+	return NLMON_MSGPOOL_CLASSES;
 }
 
 /**
@@ -247,16 +369,19 @@ void nlmon_nl_msgpool_get_stats(struct nlmon_nl_msgpool *pool,
  */
 void nlmon_nl_msgpool_reset_stats(struct nlmon_nl_msgpool *pool)
 {
+	int c;
+	
 	if (!pool)
 		return;
 	
-	pthread_mutex_lock(&pool->lock);
-	
-	pool->alloc_requests = 0;
-	pool->pool_hits = 0;
-	pool->pool_misses = 0;
+	atomic_store_explicit(&pool->alloc_requests, 0, memory_order_relaxed);
+	atomic_store_explicit(&pool->pool_hits, 0, memory_order_relaxed);
+	atomic_store_explicit(&pool->pool_misses, 0, memory_order_relaxed);
 	
-	pthread_mutex_unlock(&pool->lock);
+	for (c = 0; c < NLMON_MSGPOOL_CLASSES; c++) {
+		atomic_store_explicit(&pool->classes[c].hits, 0, memory_order_relaxed);
+		atomic_store_explicit(&pool->classes[c].misses, 0, memory_order_relaxed);
+	}
 }
 
 /**
@@ -264,35 +389,55 @@ void nlmon_nl_msgpool_reset_stats(struct nlmon_nl_msgpool *pool)
  */
 int nlmon_nl_msgpool_resize(struct nlmon_nl_msgpool *pool, void *ptr, size_t new_size)
 {
-	struct msg_buffer *buf;
-	size_t i;
+	struct msg_class *cls;
+	uint32_t index;
 	
 	if (!pool || !ptr)
 		return -EINVAL;
 	
-	pthread_mutex_lock(&pool->lock);
-	
 	/* Find buffer in pool */
-	for (i = 0; i < pool->pool_size; i++) {
-		buf = &pool->buffers[i];
-		if (buf->data == ptr && buf->in_use) {
-			if (new_size <= buf->capacity) {
-				/* Fits in existing buffer */
-				buf->size = new_size;
-				pthread_mutex_unlock(&pool->lock);
-				return 0;
-			} else {
-				/* Need larger buffer - not supported for pooled buffers */
-				pthread_mutex_unlock(&pool->lock);
-				return -ENOMEM;
-			}
-		}
-	}
+	cls = msg_class_find(pool, ptr, &index);
+	if (!cls || !atomic_load_explicit(&cls->in_use[index], memory_order_relaxed))
+		return -EINVAL;
+	
+	/* Anything up to the class size fits in place */
+	if (new_size <= cls->buffer_size)
+		return 0;
+	
+	/* Need larger buffer, see nlmon_nl_msgpool_realloc() */
+	return -ENOMEM;
+}
+
+/**
+ * Resize buffer, moving it to a larger class if needed
+ */
+void *nlmon_nl_msgpool_realloc(struct nlmon_nl_msgpool *pool, void *ptr, size_t old_size,
+                               size_t new_size)
+{
+	struct msg_class *cls;
+	uint32_t index;
+	void *data;
+	
+	if (!pool)
+		return NULL;
+	if (!ptr)
+		return nlmon_nl_msgpool_alloc(pool, new_size);
 	
-	pthread_mutex_unlock(&pool->lock);
+	cls = msg_class_find(pool, ptr, &index);
+	if (!cls)
+		return realloc(ptr, new_size);
 	
-	/* Not a pooled buffer */
-	return -EINVAL;
+	/* Growing within the class or shrinking never copies */
+	if (new_size <= cls->buffer_size)
+		return ptr;
+	
+	data = nlmon_nl_msgpool_alloc(pool, new_size);
+	if (!data)
+		return NULL;
+	
+	memcpy(data, ptr, old_size < cls->buffer_size ? old_size : cls->buffer_size);
+	nlmon_nl_msgpool_free(pool, ptr);
+	return data;
 }
 
 /**
@@ -300,27 +445,18 @@ int nlmon_nl_msgpool_resize(struct nlmon_nl_msgpool *pool, void *ptr, size_t new
  */
 size_t nlmon_nl_msgpool_get_capacity(struct nlmon_nl_msgpool *pool, void *ptr)
 {
-	struct msg_buffer *buf;
-	size_t i;
-	size_t capacity = 0;
+	struct msg_class *cls;
+	uint32_t index;
 	
 	if (!pool || !ptr)
 		return 0;
 	
-	pthread_mutex_lock(&pool->lock);
-	
 	/* Find buffer in pool */
-	for (i = 0; i < pool->pool_size; i++) {
-		buf = &pool->buffers[i];
-		if (buf->data == ptr && buf->in_use) {
-			capacity = buf->capacity;
-			break;
-		}
-	}
-	
-	pthread_mutex_unlock(&pool->lock);
+	cls = msg_class_find(pool, ptr, &index);
+	if (!cls || !atomic_load_explicit(&cls->in_use[index], memory_order_relaxed))
+		return 0;
 	
-	return capacity;
+	return cls->buffer_size;
 }
 
 /**
@@ -328,11 +464,21 @@ size_t nlmon_nl_msgpool_get_capacity(struct nlmon_nl_msgpool *pool, void *ptr)
  */
 int nlmon_nl_msgpool_preallocate(struct nlmon_nl_msgpool *pool)
 {
+	struct msg_class *cls;
+	size_t i;
+	int c;
+	
 	if (!pool)
 		return -EINVAL;
 	
-	/* Buffers are already allocated during pool creation */
-	/* This function is a no-op but provided for API completeness */
+	/* Fault in the slabs so first use of a class does not page fault */
+	for (c = 0; c < NLMON_MSGPOOL_CLASSES; c++) {
+		cls = &pool->classes[c];
+		for (i = 0; i < cls->count; i++) {
+			if (!atomic_load_explicit(&cls->in_use[i], memory_order_relaxed))
+				memset(cls->slab + i * cls->buffer_size, 0, cls->buffer_size);
+		}
+	}
 	
 	return 0;
 }
@@ -356,26 +502,12 @@ int nlmon_nl_msgpool_shrink(struct nlmon_nl_msgpool *pool, size_t target_free)
  */
 bool nlmon_nl_msgpool_is_pooled(struct nlmon_nl_msgpool *pool, void *ptr)
 {
-	struct msg_buffer *buf;
-	size_t i;
-	bool is_pooled = false;
+	uint32_t index;
 	
 	if (!pool || !ptr)
 		return false;
 	
-	pthread_mutex_lock(&pool->lock);
-	
-	for (i = 0; i < pool->pool_size; i++) {
-		buf = &pool->buffers[i];
-		if (buf->data == ptr) {
-			is_pooled = true;
-			break;
-		}
-	}
-	
-	pthread_mutex_unlock(&pool->lock);
-	
-	return is_pooled;
+	return msg_class_find(pool, ptr, &index) != NULL;
 }
 
 /**
@@ -383,15 +515,11 @@ bool nlmon_nl_msgpool_is_pooled(struct nlmon_nl_msgpool *pool, void *ptr)
  */
 double nlmon_nl_msgpool_get_utilization(struct nlmon_nl_msgpool *pool)
 {
-	double utilization;
+	struct nlmon_msgpool_stats stats;
 	
 	if (!pool || pool->pool_size == 0)
 		return 0.0;
 	
-	pthread_mutex_lock(&pool->lock);
-	utilization = (double)pool->allocated_count / pool->pool_size * 100.0;
-	pthread_mutex_unlock(&pool->lock);
-	
-	return utilization;
+	nlmon_nl_msgpool_get_stats(pool, &stats);
+	return (double)stats.allocated_count / pool->pool_size * 100.0;
 }
-
@@ -7,7 +7,10 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <endian.h>
+#include <stddef.h>
 #include <arpa/inet.h>
+#include <linux/filter.h>
 #include <linux/netlink.h>
 #include <linux/netfilter/nfnetlink.h>
 #include <linux/netfilter/nfnetlink_conntrack.h>
@@ -20,6 +23,7 @@
 
 #include "nlmon_netlink.h"
 #include "nlmon_nl_netfilter.h"
+#include "nlmon_nl_dispatch.h"
 #include "event_processor.h"
 
 /**
@@ -32,6 +36,7 @@ int nlmon_nf_msg_handler(struct nl_msg *msg, void *arg)
 {
 	struct nlmon_nl_manager *mgr = (struct nlmon_nl_manager *)arg;
 	struct nlmsghdr *nlh = nlmsg_hdr(msg);
+	const struct nlmon_nl_msg_desc *desc;
 	struct nfgenmsg *nfmsg;
 	struct nlmon_event evt;
 	int ret = 0;
@@ -41,7 +46,7 @@ int nlmon_nf_msg_handler(struct nl_msg *msg, void *arg)
 	
 	/* Initialize event structure */
 	memset(&evt, 0, sizeof(evt));
-	evt.timestamp = time(NULL) * 1000000000ULL; /* Convert to nanoseconds */
+	evt.timestamp = nlmon_nl_recv_timestamp();
 	evt.netlink.protocol = NETLINK_NETFILTER;
 	evt.netlink.msg_type = nlh->nlmsg_type;
 	evt.netlink.msg_flags = nlh->nlmsg_flags;
@@ -71,33 +76,13 @@ int nlmon_nf_msg_handler(struct nl_msg *msg, void *arg)
 		return NL_STOP;
 	}
 	
-	/* Route to appropriate parser based on subsystem */
-	switch (subsys) {
-	case NFNL_SUBSYS_CTNETLINK:
-		/* Connection tracking subsystem */
-		ret = nlmon_parse_conntrack_msg(nlh, &evt);
-		evt.event_type = nlh->nlmsg_type;
-		break;
-		
-	case NFNL_SUBSYS_CTNETLINK_EXP:
-		/* Connection tracking expect subsystem */
-		/* Not implemented yet */
-		return NL_SKIP;
-		
-	case NFNL_SUBSYS_QUEUE:
-		/* Netfilter queue subsystem */
-		/* Not implemented yet */
-		return NL_SKIP;
-		
-	case NFNL_SUBSYS_ULOG:
-		/* Netfilter userspace logging */
-		/* Not implemented yet */
-		return NL_SKIP;
-		
-	default:
-		/* Unknown or unhandled subsystem */
+	/* Only connection tracking has a parser, other subsystems are skipped */
+	desc = nlmon_nl_msg_lookup(NETLINK_NETFILTER, nlh->nlmsg_type);
+	if (!desc || !(desc->subscribers & NLMON_NL_SUB_EVENTS))
 		return NL_SKIP;
-	}
+	
+	ret = desc->parse(nlh, &evt);
+	evt.event_type = nlh->nlmsg_type;
 	
 	/* If parsing failed, skip this message */
 	if (ret < 0) {
@@ -107,9 +92,7 @@ int nlmon_nf_msg_handler(struct nl_msg *msg, void *arg)
 	}
 	
 	/* Forward event to nlmon event processor if callback is set */
-	if (mgr->event_callback) {
-		mgr->event_callback(&evt, mgr->user_data);
-	}
+	nlmon_nl_deliver_event(mgr, &evt);
 	
 	/* Free any allocated data in the event */
 	if (evt.netlink.data.generic) {
@@ -281,3 +264,129 @@ int nlmon_parse_conntrack_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 	
 	return 0;
 }
+
+/* Jump targets of a conntrack filter, resolved once the program is laid out */
+#define CT_JUMP_PASS      0xfe
+#define CT_JUMP_REJECT    0xff
+
+/* Conntrack attributes start after the nfgenmsg header */
+#define CT_ATTR_OFFSET    (NLMSG_HDRLEN + NLMSG_ALIGN(sizeof(struct nfgenmsg)))
+
+/* Subsystem byte of the host order nlmsg_type */
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+#define CT_SUBSYS_OFFSET  (offsetof(struct nlmsghdr, nlmsg_type) + 1)
+#else
+#define CT_SUBSYS_OFFSET  offsetof(struct nlmsghdr, nlmsg_type)
+#endif
+
+struct ct_prog {
+	struct sock_filter *insns;
+	size_t len;
+	size_t max;
+};
+
+static void ct_emit(struct ct_prog *p, uint16_t code, uint8_t jt, uint8_t jf, uint32_t k)
+{
+	if (p->len < p->max)
+		p->insns[p->len] = (struct sock_filter){ code, jt, jf, k };
+	p->len++;
+}
+
+/* Find attribute @type at or inside the attribute at A, its offset or 0 in A */
+static void ct_find_attr(struct ct_prog *p, uint32_t type, int nested)
+{
+	ct_emit(p, BPF_LDX | BPF_W | BPF_IMM, 0, 0, type);
+	ct_emit(p, BPF_LD | BPF_W | BPF_ABS, 0, 0,
+	        SKF_AD_OFF + (nested ? SKF_AD_NLATTR_NEST : SKF_AD_NLATTR));
+}
+
+/* Load a top-level attribute of @size bytes into A, 0 if it is missing */
+static void ct_load_attr(struct ct_prog *p, uint32_t type, uint16_t size)
+{
+	ct_emit(p, BPF_LD | BPF_W | BPF_IMM, 0, 0, CT_ATTR_OFFSET);
+	ct_find_attr(p, type, 0);
+	ct_emit(p, BPF_JMP | BPF_JEQ | BPF_K, 2, 0, 0);
+	ct_emit(p, BPF_MISC | BPF_TAX, 0, 0, 0);
+	ct_emit(p, BPF_LD | size | BPF_IND, 0, 0, NLA_HDRLEN);
+}
+
+/**
+ * Compile the connection part of a conntrack filter to classic BPF
+ *
+ * Attributes are located with the kernel's netlink attribute lookup
+ * extensions, and their values are big endian like BPF loads.
+ */
+int nlmon_ct_filter_compile(const struct nlmon_ct_filter *filter,
+                            struct sock_filter *insns, size_t max)
+{
+	struct ct_prog p = { .insns = insns, .max = max };
+	struct sock_filter *insn;
+	size_t i;
+	
+	if (!filter || (!insns && max))
+		return -EINVAL;
+	if (filter->l3proto && filter->l3proto != AF_INET && filter->l3proto != AF_INET6)
+		return -EINVAL;
+	
+	if (!filter->l3proto && !filter->l4proto && !filter->match_zone && !filter->mark_mask)
+		return 0;
+	
+	/* Other netfilter subsystems are left alone */
+	ct_emit(&p, BPF_LD | BPF_B | BPF_ABS, 0, 0, CT_SUBSYS_OFFSET);
+	ct_emit(&p, BPF_JMP | BPF_JEQ | BPF_K, 0, CT_JUMP_PASS, NFNL_SUBSYS_CTNETLINK);
+	
+	if (filter->l3proto) {
+		ct_emit(&p, BPF_LD | BPF_B | BPF_ABS, 0, 0,
+		        NLMSG_HDRLEN + offsetof(struct nfgenmsg, nfgen_family));
+		ct_emit(&p, BPF_JMP | BPF_JEQ | BPF_K, 0, CT_JUMP_REJECT, filter->l3proto);
+	}
+	
+	if (filter->mark_mask) {
+		ct_load_attr(&p, CTA_MARK, BPF_W);
+		ct_emit(&p, BPF_ALU | BPF_AND | BPF_K, 0, 0, filter->mark_mask);
+		ct_emit(&p, BPF_JMP | BPF_JEQ | BPF_K, 0, CT_JUMP_REJECT,
+		        filter->mark & filter->mark_mask);
+	}
+	
+	if (filter->match_zone) {
+		ct_load_attr(&p, CTA_ZONE, BPF_H);
+		ct_emit(&p, BPF_JMP | BPF_JEQ | BPF_K, 0, CT_JUMP_REJECT, filter->zone);
+	}
+	
+	/* CTA_TUPLE_ORIG > CTA_TUPLE_PROTO > CTA_PROTO_NUM */
+	if (filter->l4proto) {
+		ct_emit(&p, BPF_LD | BPF_W | BPF_IMM, 0, 0, CT_ATTR_OFFSET);
+		ct_find_attr(&p, CTA_TUPLE_ORIG, 0);
+		ct_emit(&p, BPF_JMP | BPF_JEQ | BPF_K, CT_JUMP_REJECT, 0, 0);
+		ct_find_attr(&p, CTA_TUPLE_PROTO, 1);
+		ct_emit(&p, BPF_JMP | BPF_JEQ | BPF_K, CT_JUMP_REJECT, 0, 0);
+		ct_find_attr(&p, CTA_PROTO_NUM, 1);
+		ct_emit(&p, BPF_JMP | BPF_JEQ | BPF_K, CT_JUMP_REJECT, 0, 0);
+		ct_emit(&p, BPF_MISC | BPF_TAX, 0, 0, 0);
+		ct_emit(&p, BPF_LD | BPF_B | BPF_IND, 0, 0, NLA_HDRLEN);
+		ct_emit(&p, BPF_JMP | BPF_JEQ | BPF_K, 0, CT_JUMP_REJECT, filter->l4proto);
+	}
+	
+	/* Matching messages skip the reject and fall through */
+	ct_emit(&p, BPF_JMP | BPF_JA, 0, 0, 1);
+	ct_emit(&p, BPF_RET | BPF_K, 0, 0, 0);
+	
+	if (p.len > max)
+		return -ENOSPC;
+	
+	for (i = 0; i < p.len; i++) {
+		insn = &insns[i];
+		if (BPF_CLASS(insn->code) != BPF_JMP || BPF_OP(insn->code) == BPF_JA)
+			continue;
+		if (insn->jt == CT_JUMP_PASS)
+			insn->jt = p.len - i - 1;
+		else if (insn->jt == CT_JUMP_REJECT)
+			insn->jt = p.len - i - 2;
+		if (insn->jf == CT_JUMP_PASS)
+			insn->jf = p.len - i - 1;
+		else if (insn->jf == CT_JUMP_REJECT)
+			insn->jf = p.len - i - 2;
+	}
+	
+	return (int)p.len;
+}
@@ -0,0 +1,558 @@
+/* nlmon_nl_netns.c - Netlink monitoring across network namespaces
+ *
+ * A netlink socket belongs to the namespace of the thread that created
+ * it, so each manager's sockets are opened after setns() into the
+ * namespace and the thread then returns to its own. The namespace fd
+ * stays open for reconnects. Attached namespaces are kept in an
+ * id_table keyed by inode, holding pointers since epoll refers to the
+ * entries and table entries move.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <linux/netlink.h>
+
+#include "nlmon_nl_netns.h"
+#include "nlmon_netlink.h"
+#include "event_processor.h"
+#include "namespace_tracker.h"
+#include "id_table.h"
+
+#define NETNS_PROTOCOLS 4
+#define NETNS_EPOLL_EVENTS 64
+
+struct netns_entry;
+
+/* A socket of an attached namespace, the epoll data of its fd */
+struct netns_sock {
+	struct netns_entry *ns;
+	int protocol;
+	int fd;                          /* Registered fd, -1 if none */
+};
+
+/* Attached namespace */
+struct netns_entry {
+	struct nlmon_nl_netns_set *set;
+	struct nlmon_nl_manager *mgr;
+	uint64_t ino;
+	uint64_t tag;                    /* netlink.netns of its events */
+	int fd;                          /* Namespace fd, held for reconnects */
+	uint32_t generation;             /* Sync that last saw it */
+	int broken;                      /* A socket could not be reconnected */
+	unsigned int reconnects;         /* mgr->reconnects when registered */
+	char name[NAMESPACE_NAME_MAX];
+	struct netns_sock socks[NETNS_PROTOCOLS];
+};
+
+/* Table entry */
+struct netns_ref {
+	struct id_slot slot;
+	struct netns_entry *ns;
+};
+
+struct nlmon_nl_netns_set {
+	struct nlmon_nl_netns_config config;
+	int epoll_fd;
+	int self_fd;                     /* Our own namespace, to return to */
+	uint64_t self_ino;
+	uint32_t generation;
+	struct id_table entries;
+	struct nlmon_nl_netns_stats stats;
+};
+
+static const int netns_protocols[NETNS_PROTOCOLS] = {
+	NETLINK_ROUTE, NETLINK_GENERIC, NETLINK_SOCK_DIAG, NETLINK_NETFILTER,
+};
+
+static int netns_protocol_enabled(const struct nlmon_nl_netns_config *config, int protocol)
+{
+	switch (protocol) {
+	case NETLINK_ROUTE:
+		return config->enable_route;
+	case NETLINK_GENERIC:
+		return config->enable_genl;
+	case NETLINK_SOCK_DIAG:
+		return config->enable_diag;
+	case NETLINK_NETFILTER:
+		return config->enable_netfilter;
+	default:
+		return 0;
+	}
+}
+
+static int netns_protocol_enable(struct nlmon_nl_manager *mgr, int protocol)
+{
+	switch (protocol) {
+	case NETLINK_ROUTE:
+		return nlmon_nl_enable_route(mgr);
+	case NETLINK_GENERIC:
+		return nlmon_nl_enable_generic(mgr);
+	case NETLINK_SOCK_DIAG:
+		return nlmon_nl_enable_diag(mgr);
+	case NETLINK_NETFILTER:
+		return nlmon_nl_enable_netfilter(mgr);
+	default:
+		return -EINVAL;
+	}
+}
+
+static int netns_protocol_fd(struct nlmon_nl_manager *mgr, int protocol)
+{
+	switch (protocol) {
+	case NETLINK_ROUTE:
+		return nlmon_nl_get_route_fd(mgr);
+	case NETLINK_GENERIC:
+		return nlmon_nl_get_genl_fd(mgr);
+	case NETLINK_SOCK_DIAG:
+		return nlmon_nl_get_diag_fd(mgr);
+	case NETLINK_NETFILTER:
+		return nlmon_nl_get_nf_fd(mgr);
+	default:
+		return -1;
+	}
+}
+
+static int netns_protocol_process(struct nlmon_nl_manager *mgr, int protocol)
+{
+	switch (protocol) {
+	case NETLINK_ROUTE:
+		return nlmon_nl_process_route(mgr);
+	case NETLINK_GENERIC:
+		return nlmon_nl_process_genl(mgr);
+	case NETLINK_SOCK_DIAG:
+		return nlmon_nl_process_diag(mgr);
+	case NETLINK_NETFILTER:
+		return nlmon_nl_process_nf(mgr);
+	default:
+		return -EINVAL;
+	}
+}
+
+/* Manager callback, tags the event with its namespace */
+static void netns_deliver(struct nlmon_event *evt, void *user_data)
+{
+	struct netns_entry *ns = user_data;
+	struct nlmon_nl_netns_set *set = ns->set;
+	
+	evt->netlink.netns = ns->tag;
+	set->stats.events++;
+	if (set->config.event_callback)
+		set->config.event_callback(evt, set->config.user_data);
+}
+
+static struct netns_entry *netns_lookup(struct nlmon_nl_netns_set *set, uint64_t ino)
+{
+	struct netns_ref *ref = id_table_find(&set->entries, ino);
+	
+	return ref ? ref->ns : NULL;
+}
+
+/* Register a socket's current fd, after attach or a reconnect */
+static void netns_sock_register(struct nlmon_nl_netns_set *set, struct netns_sock *sk)
+{
+	struct epoll_event ev;
+	int fd = netns_protocol_fd(sk->ns->mgr, sk->protocol);
+	
+	/* A reconnect closed the old fd, which took it out of the set, and
+	 * the new socket may well have been given the same number */
+	sk->fd = -1;
+	if (fd < 0) {
+		sk->ns->broken = 1;
+		return;
+	}
+	
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = sk;
+	if (epoll_ctl(set->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0 &&
+	    (errno != EEXIST || epoll_ctl(set->epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0)) {
+		sk->ns->broken = 1;
+		return;
+	}
+	sk->fd = fd;
+}
+
+static void netns_entry_free(struct nlmon_nl_netns_set *set, struct netns_entry *ns)
+{
+	int i;
+	
+	for (i = 0; i < NETNS_PROTOCOLS; i++) {
+		if (ns->socks[i].fd >= 0)
+			epoll_ctl(set->epoll_fd, EPOLL_CTL_DEL, ns->socks[i].fd, NULL);
+	}
+	nlmon_nl_manager_destroy(ns->mgr);
+	close(ns->fd);
+	free(ns);
+}
+
+/* Open the sockets of the namespace behind fd, taking ownership of fd */
+static int netns_attach_fd(struct nlmon_nl_netns_set *set, int fd, uint64_t ino,
+                           const char *name)
+{
+	struct netns_entry *ns;
+	struct netns_ref *ref;
+	int created;
+	int ret = 0;
+	int i;
+	
+	ns = calloc(1, sizeof(*ns));
+	if (!ns) {
+		ret = -ENOMEM;
+		goto err_close;
+	}
+	
+	ns->set = set;
+	ns->ino = ino;
+	ns->tag = ino == set->self_ino ? 0 : ino;
+	ns->fd = fd;
+	ns->generation = set->generation;
+	snprintf(ns->name, sizeof(ns->name), "%s", name ? name : "");
+	for (i = 0; i < NETNS_PROTOCOLS; i++) {
+		ns->socks[i].ns = ns;
+		ns->socks[i].protocol = netns_protocols[i];
+		ns->socks[i].fd = -1;
+	}
+	
+	ns->mgr = nlmon_nl_manager_init();
+	if (!ns->mgr) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+	ns->mgr->netns_fd = fd;
+	nlmon_nl_set_callback(ns->mgr, netns_deliver, ns);
+	
+	if (set->config.setup) {
+		ret = set->config.setup(ns->mgr, set->config.user_data);
+		if (ret < 0)
+			goto err_mgr;
+	}
+	
+	if (setns(fd, CLONE_NEWNET) < 0) {
+		ret = -errno;
+		goto err_mgr;
+	}
+	for (i = 0; i < NETNS_PROTOCOLS && ret >= 0; i++) {
+		if (netns_protocol_enabled(&set->config, netns_protocols[i]))
+			ret = netns_protocol_enable(ns->mgr, netns_protocols[i]);
+	}
+	if (setns(set->self_fd, CLONE_NEWNET) < 0) {
+		int err = errno;
+		
+		fprintf(stderr, "Failed to return to own network namespace: %s\n",
+		        strerror(err));
+		if (ret >= 0)
+			ret = -err;
+	}
+	if (ret < 0)
+		goto err_mgr;
+	
+	for (i = 0; i < NETNS_PROTOCOLS; i++) {
+		if (netns_protocol_enabled(&set->config, netns_protocols[i]))
+			netns_sock_register(set, &ns->socks[i]);
+	}
+	if (ns->broken) {
+		ret = -EIO;
+		goto err_mgr;
+	}
+	
+	ref = id_table_get(&set->entries, ino, &created);
+	if (!ref) {
+		ret = -ENOMEM;
+		goto err_mgr;
+	}
+	ref->ns = ns;
+	set->stats.attached++;
+	return 0;
+	
+err_mgr:
+	for (i = 0; i < NETNS_PROTOCOLS; i++) {
+		if (ns->socks[i].fd >= 0)
+			epoll_ctl(set->epoll_fd, EPOLL_CTL_DEL, ns->socks[i].fd, NULL);
+	}
+	nlmon_nl_manager_destroy(ns->mgr);
+err_free:
+	free(ns);
+err_close:
+	close(fd);
+	set->stats.attach_failed++;
+	return ret;
+}
+
+/* Open a namespace file and read its inode */
+static int netns_open(const char *path, uint64_t *ino)
+{
+	struct stat st;
+	int fd;
+	
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st) < 0) {
+		int ret = -errno;
+		
+		close(fd);
+		return ret;
+	}
+	
+	*ino = (uint64_t)st.st_ino;
+	return fd;
+}
+
+/**
+ * Create an empty netns set
+ */
+struct nlmon_nl_netns_set *nlmon_nl_netns_create(const struct nlmon_nl_netns_config *config)
+{
+	struct nlmon_nl_netns_set *set;
+	
+	if (!config)
+		return NULL;
+	
+	set = calloc(1, sizeof(*set));
+	if (!set)
+		return NULL;
+	
+	set->config = *config;
+	set->entries = (struct id_table)ID_TABLE_INIT(struct netns_ref);
+	
+	set->self_fd = netns_open("/proc/self/ns/net", &set->self_ino);
+	if (set->self_fd < 0)
+		goto err_free;
+	
+	set->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (set->epoll_fd < 0)
+		goto err_self;
+	
+	return set;
+	
+err_self:
+	close(set->self_fd);
+err_free:
+	free(set);
+	return NULL;
+}
+
+/**
+ * Detach all namespaces and free the set
+ */
+void nlmon_nl_netns_destroy(struct nlmon_nl_netns_set *set)
+{
+	size_t i;
+	
+	if (!set)
+		return;
+	
+	for (i = 0; i < set->entries.size; i++) {
+		struct netns_ref *ref = (struct netns_ref *)id_table_slot(&set->entries, i);
+		
+		if (ref->slot.used)
+			netns_entry_free(set, ref->ns);
+	}
+	id_table_free(&set->entries);
+	
+	close(set->epoll_fd);
+	close(set->self_fd);
+	free(set);
+}
+
+/**
+ * Monitor the namespace behind a path
+ */
+int nlmon_nl_netns_attach(struct nlmon_nl_netns_set *set, const char *path,
+                          const char *name)
+{
+	struct netns_entry *ns;
+	uint64_t ino;
+	int fd;
+	
+	if (!set || !path)
+		return -EINVAL;
+	
+	fd = netns_open(path, &ino);
+	if (fd < 0)
+		return fd;
+	
+	ns = netns_lookup(set, ino);
+	if (ns) {
+		ns->generation = set->generation;
+		close(fd);
+		return 0;
+	}
+	
+	return netns_attach_fd(set, fd, ino, name);
+}
+
+/**
+ * Stop monitoring a namespace
+ */
+int nlmon_nl_netns_detach(struct nlmon_nl_netns_set *set, uint64_t ino)
+{
+	struct netns_ref *ref;
+	
+	if (!set)
+		return -EINVAL;
+	
+	ref = id_table_find(&set->entries, ino);
+	if (!ref)
+		return -ENOENT;
+	
+	netns_entry_free(set, ref->ns);
+	id_table_remove(&set->entries, ref);
+	set->stats.detached++;
+	return 0;
+}
+
+/* Attach a tracked namespace, or mark it seen if it is attached */
+static void netns_sync_one(const struct netns_info *nsinfo, const char *path, void *arg)
+{
+	struct nlmon_nl_netns_set *set = arg;
+	struct netns_entry *ns;
+	uint64_t ino;
+	int fd;
+	
+	if (!set->config.include_current && (uint64_t)nsinfo->nsid == set->self_ino)
+		return;
+	
+	ns = netns_lookup(set, (uint64_t)nsinfo->nsid);
+	if (ns && !ns->broken) {
+		ns->generation = set->generation;
+		return;
+	}
+	if (ns)
+		nlmon_nl_netns_detach(set, ns->ino);
+	
+	fd = netns_open(path, &ino);
+	if (fd < 0) {
+		set->stats.attach_failed++;
+		return;
+	}
+	
+	/* The process or mount left, the path names another namespace */
+	if (ino != (uint64_t)nsinfo->nsid) {
+		close(fd);
+		set->stats.attach_failed++;
+		return;
+	}
+	
+	netns_attach_fd(set, fd, ino, nsinfo->name);
+}
+
+/**
+ * Match the set to the tracked namespaces
+ */
+int nlmon_nl_netns_sync(struct nlmon_nl_netns_set *set, struct namespace_tracker *tracker)
+{
+	size_t i;
+	
+	if (!set || !tracker)
+		return -EINVAL;
+	
+	set->generation++;
+	if (namespace_tracker_foreach(tracker, netns_sync_one, set) < 0)
+		return -EIO;
+	
+	/* Sweep the namespaces the tracker did not report */
+	for (i = 0; i < set->entries.size; ) {
+		struct netns_ref *ref = (struct netns_ref *)id_table_slot(&set->entries, i);
+		
+		if (ref->slot.used && ref->ns->generation != set->generation) {
+			netns_entry_free(set, ref->ns);
+			id_table_remove(&set->entries, ref);
+			set->stats.detached++;
+			continue;
+		}
+		i++;
+	}
+	
+	return (int)set->entries.used;
+}
+
+/**
+ * Epoll fd of the set
+ */
+int nlmon_nl_netns_get_fd(struct nlmon_nl_netns_set *set)
+{
+	return set ? set->epoll_fd : -1;
+}
+
+/**
+ * Receive from the ready sockets
+ */
+int nlmon_nl_netns_process(struct nlmon_nl_netns_set *set, int timeout_ms)
+{
+	struct epoll_event events[NETNS_EPOLL_EVENTS];
+	int n;
+	int i;
+	
+	if (!set)
+		return -EINVAL;
+	
+	n = epoll_wait(set->epoll_fd, events, NETNS_EPOLL_EVENTS, timeout_ms);
+	if (n < 0)
+		return errno == EINTR ? 0 : -errno;
+	
+	for (i = 0; i < n; i++) {
+		struct netns_sock *sk = events[i].data.ptr;
+		
+		struct netns_entry *ns = sk->ns;
+		int j;
+		
+		/* Errors are logged and lost sockets reconnected in there */
+		netns_protocol_process(ns->mgr, sk->protocol);
+		if (ns->mgr->reconnects == ns->reconnects)
+			continue;
+		
+		ns->reconnects = ns->mgr->reconnects;
+		for (j = 0; j < NETNS_PROTOCOLS; j++) {
+			if (netns_protocol_enabled(&set->config, netns_protocols[j]))
+				netns_sock_register(set, &ns->socks[j]);
+		}
+	}
+	
+	return n;
+}
+
+/**
+ * Name of an attached namespace
+ */
+int nlmon_nl_netns_name(struct nlmon_nl_netns_set *set, uint64_t ino, char *buf, size_t len)
+{
+	struct netns_entry *ns;
+	
+	if (!set || !buf || len == 0)
+		return -EINVAL;
+	
+	ns = netns_lookup(set, ino);
+	if (!ns)
+		return -ENOENT;
+	
+	snprintf(buf, len, "%s", ns->name);
+	return 0;
+}
+
+/**
+ * Counters of the set
+ */
+void nlmon_nl_netns_get_stats(struct nlmon_nl_netns_set *set, struct nlmon_nl_netns_stats *stats)
+{
+	if (!stats)
+		return;
+	
+	memset(stats, 0, sizeof(*stats));
+	if (!set)
+		return;
+	
+	*stats = set->stats;
+	stats->namespaces = set->entries.used;
+}
@@ -15,16 +15,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <endian.h>
 #include <linux/rtnetlink.h>
 #include <linux/if_link.h>
 #include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
 
 #include <netlink/netlink.h>
 #include <netlink/msg.h>
 #include <netlink/attr.h>
 
 #include "nlmon_nl_optimize.h"
+#include "nlmon_nl_dispatch.h"
 #include "nlmon_nl_route.h"
+#include "nlmon_nl_netfilter.h"
 
 /**
  * Fast-path link message parser
@@ -244,49 +250,14 @@ int nlmon_extract_link_attrs_batch(struct nlmsghdr *nlh,
 	return 0;
 }
 
-/**
- * Inline message type check
- * 
- * Fast check for common message types without function call overhead.
- */
-static inline bool is_link_message(uint16_t msg_type)
-{
-	return msg_type == RTM_NEWLINK || msg_type == RTM_DELLINK || msg_type == RTM_GETLINK;
-}
-
-static inline bool is_addr_message(uint16_t msg_type)
-{
-	return msg_type == RTM_NEWADDR || msg_type == RTM_DELADDR || msg_type == RTM_GETADDR;
-}
-
-static inline bool is_route_message(uint16_t msg_type)
-{
-	return msg_type == RTM_NEWROUTE || msg_type == RTM_DELROUTE || msg_type == RTM_GETROUTE;
-}
-
 /**
  * Fast message type classification
  */
-enum nlmon_msg_class {
-	MSG_CLASS_LINK,
-	MSG_CLASS_ADDR,
-	MSG_CLASS_ROUTE,
-	MSG_CLASS_NEIGH,
-	MSG_CLASS_OTHER
-};
-
 enum nlmon_msg_class nlmon_classify_route_msg(uint16_t msg_type)
 {
-	if (is_link_message(msg_type))
-		return MSG_CLASS_LINK;
-	if (is_addr_message(msg_type))
-		return MSG_CLASS_ADDR;
-	if (is_route_message(msg_type))
-		return MSG_CLASS_ROUTE;
-	if (msg_type == RTM_NEWNEIGH || msg_type == RTM_DELNEIGH || msg_type == RTM_GETNEIGH)
-		return MSG_CLASS_NEIGH;
-	
-	return MSG_CLASS_OTHER;
+	const struct nlmon_nl_msg_desc *desc = nlmon_nl_msg_lookup(NETLINK_ROUTE, msg_type);
+	
+	return desc ? desc->msg_class : MSG_CLASS_OTHER;
 }
 
 /**
@@ -424,20 +395,21 @@ int nlmon_iterate_messages_optimized(void *buf, size_t len,
 {
 	struct nlmsghdr *nlh;
 	struct nlmsghdr *next_nlh;
+	size_t step, rest;
 	int processed = 0;
 	
 	if (!buf || !handler || len == 0)
 		return -EINVAL;
 	
-	for (nlh = (struct nlmsghdr *)buf;
-	     NLMSG_OK(nlh, len);
-	     nlh = NLMSG_NEXT(nlh, len)) {
+	/* Step by hand: NLMSG_NEXT would wrap len on an unpadded last message */
+	for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = next_nlh, len = rest) {
+		step = NLMSG_ALIGN(nlh->nlmsg_len);
+		rest = step < len ? len - step : 0;
+		next_nlh = (struct nlmsghdr *)((char *)nlh + step);
 		
 		/* Prefetch next message */
-		next_nlh = NLMSG_NEXT(nlh, len);
-		if (NLMSG_OK(next_nlh, len)) {
+		if (NLMSG_OK(next_nlh, rest))
 			prefetch_message(next_nlh);
-		}
 		
 		/* Process current message */
 		if (handler(nlh, user_data) == 0)
@@ -447,3 +419,402 @@ int nlmon_iterate_messages_optimized(void *buf, size_t len,
 	return processed;
 }
 
+
+/*
+ * Table-driven decoding
+ *
+ * Each message class is described by a family header copy list and an
+ * attribute table indexed by type. Descriptors name the destination
+ * field directly, so one loop serves every RTM and conntrack class.
+ */
+
+/* Store an integer with the width of its destination field */
+static inline void nl_store_uint(void *dst, uint8_t size, uint64_t v)
+{
+	switch (size) {
+	case 1:
+		*(uint8_t *)dst = (uint8_t)v;
+		break;
+	case 2:
+		*(uint16_t *)dst = (uint16_t)v;
+		break;
+	case 4:
+		*(uint32_t *)dst = (uint32_t)v;
+		break;
+	case 8:
+		*(uint64_t *)dst = v;
+		break;
+	}
+}
+
+/* Attribute payloads are only 4 byte aligned, load through memcpy */
+static inline uint64_t nl_load_uint(const void *src, uint8_t size)
+{
+	uint8_t v8;
+	uint16_t v16;
+	uint32_t v32;
+	uint64_t v64;
+	
+	switch (size) {
+	case 1:
+		memcpy(&v8, src, 1);
+		return v8;
+	case 2:
+		memcpy(&v16, src, 2);
+		return v16;
+	case 4:
+		memcpy(&v32, src, 4);
+		return v32;
+	default:
+		memcpy(&v64, src, 8);
+		return v64;
+	}
+}
+
+/* Wire width of the integer and address kinds */
+static const uint8_t nl_kind_width[] = {
+	[NLMON_NL_ATTR_U8] = 1,
+	[NLMON_NL_ATTR_U16] = 2,
+	[NLMON_NL_ATTR_U32] = 4,
+	[NLMON_NL_ATTR_U64] = 8,
+	[NLMON_NL_ATTR_BE16] = 2,
+	[NLMON_NL_ATTR_BE32] = 4,
+	[NLMON_NL_ATTR_BE64] = 8,
+	[NLMON_NL_ATTR_ADDR4] = 4,
+	[NLMON_NL_ATTR_ADDR6] = 16,
+};
+
+static void nl_decode_attrs(const struct nlmon_nl_attr_table *table,
+                            struct nlattr *head, int len, int family, char *out)
+{
+	struct nlattr *attr;
+	int remaining;
+	
+	nla_for_each_attr(attr, head, len, remaining) {
+		const struct nlmon_nl_attr_desc *d;
+		int type = nla_type(attr);
+		int alen = nla_len(attr);
+		const void *data = nla_data(attr);
+		char *dst;
+		
+		if (type > table->maxtype)
+			continue;
+		
+		d = &table->desc[type];
+		dst = out + d->offset;
+		
+		switch (d->kind) {
+		case NLMON_NL_ATTR_NONE:
+			break;
+			
+		case NLMON_NL_ATTR_U8:
+		case NLMON_NL_ATTR_U16:
+		case NLMON_NL_ATTR_U32:
+		case NLMON_NL_ATTR_U64:
+			if (alen < nl_kind_width[d->kind])
+				break;
+			nl_store_uint(dst, d->size, nl_load_uint(data, nl_kind_width[d->kind]));
+			break;
+			
+		case NLMON_NL_ATTR_BE16:
+			if (alen < 2)
+				break;
+			nl_store_uint(dst, d->size, ntohs((uint16_t)nl_load_uint(data, 2)));
+			break;
+			
+		case NLMON_NL_ATTR_BE32:
+			if (alen < 4)
+				break;
+			nl_store_uint(dst, d->size, ntohl((uint32_t)nl_load_uint(data, 4)));
+			break;
+			
+		case NLMON_NL_ATTR_BE64:
+			if (alen < 8)
+				break;
+			nl_store_uint(dst, d->size, be64toh(nl_load_uint(data, 8)));
+			break;
+			
+		case NLMON_NL_ATTR_STRING:
+			if (alen <= 0)
+				break;
+			if ((size_t)alen >= d->size)
+				alen = d->size - 1;
+			memcpy(dst, data, alen);
+			dst[alen] = '\0';
+			break;
+			
+		case NLMON_NL_ATTR_BINARY:
+			if (alen <= d->size)
+				memcpy(dst, data, alen);
+			break;
+			
+		case NLMON_NL_ATTR_ADDR:
+			if (family == AF_INET && alen >= 4)
+				inet_ntop(AF_INET, data, dst, d->size);
+			else if (family == AF_INET6 && alen >= 16)
+				inet_ntop(AF_INET6, data, dst, d->size);
+			break;
+			
+		case NLMON_NL_ATTR_ADDR4:
+		case NLMON_NL_ATTR_ADDR6:
+			if (alen < nl_kind_width[d->kind])
+				break;
+			inet_ntop(d->kind == NLMON_NL_ATTR_ADDR4 ? AF_INET : AF_INET6,
+			          data, dst, d->size);
+			break;
+			
+		case NLMON_NL_ATTR_NESTED:
+			nl_decode_attrs(d->nested, (struct nlattr *)data, alen, family, dst);
+			break;
+		}
+	}
+}
+
+/**
+ * Table-driven attribute stream decoder
+ */
+void nlmon_nl_attrs_decode(const struct nlmon_nl_attr_table *table,
+                           struct nlattr *head, int len, void *out)
+{
+	if (!table || !head || !out)
+		return;
+	
+	nl_decode_attrs(table, head, len, AF_UNSPEC, out);
+}
+
+/**
+ * Table-driven message decoder
+ */
+int nlmon_nl_table_decode(const struct nlmon_nl_decode_table *table,
+                          struct nlmsghdr *nlh, void *out)
+{
+	const unsigned char *hdr;
+	uint8_t i;
+	
+	if (!table || !nlh || !out)
+		return -EINVAL;
+	
+	if (!nlmsg_valid_hdr(nlh, table->hdrlen))
+		return -NLE_MSG_TOOSHORT;
+	
+	memset(out, 0, table->out_size);
+	
+	hdr = nlmsg_data(nlh);
+	for (i = 0; i < table->nhdr; i++) {
+		const struct nlmon_nl_hdr_desc *h = &table->hdr[i];
+		
+		nl_store_uint((char *)out + h->dst, h->dst_size, nl_load_uint(hdr + h->src, h->src_size));
+	}
+	
+	nl_decode_attrs(&table->attrs, nlmsg_attrdata(nlh, table->hdrlen),
+	                nlmsg_attrlen(nlh, table->hdrlen), hdr[0], out);
+	
+	if (table->finish)
+		table->finish(nlh, out);
+	
+	return 0;
+}
+
+/* Link messages */
+
+static const struct nlmon_nl_hdr_desc link_hdr[] = {
+	NL_HDR(struct ifinfomsg, ifi_index, struct nlmon_link_info, ifindex),
+	NL_HDR(struct ifinfomsg, ifi_flags, struct nlmon_link_info, flags),
+};
+
+static const struct nlmon_nl_attr_desc link_attrs[IFLA_OPERSTATE + 1] = {
+	[IFLA_IFNAME] = NL_ATTR(struct nlmon_link_info, ifname, NLMON_NL_ATTR_STRING),
+	[IFLA_MTU] = NL_ATTR(struct nlmon_link_info, mtu, NLMON_NL_ATTR_U32),
+	[IFLA_ADDRESS] = NL_ATTR(struct nlmon_link_info, addr, NLMON_NL_ATTR_BINARY),
+	[IFLA_QDISC] = NL_ATTR(struct nlmon_link_info, qdisc, NLMON_NL_ATTR_STRING),
+	[IFLA_OPERSTATE] = NL_ATTR(struct nlmon_link_info, operstate, NLMON_NL_ATTR_U8),
+};
+
+static void link_finish(const struct nlmsghdr *nlh, void *out)
+{
+	struct nlmon_link_info *link_info = out;
+	
+	(void)nlh;
+	
+	/* Fallback to if_indextoname if name not in attributes */
+	if (link_info->ifname[0] == '\0')
+		if_indextoname(link_info->ifindex, link_info->ifname);
+}
+
+const struct nlmon_nl_decode_table nlmon_nl_link_decoder = {
+	.hdrlen = sizeof(struct ifinfomsg),
+	.hdr = link_hdr,
+	.nhdr = sizeof(link_hdr) / sizeof(link_hdr[0]),
+	.attrs = NL_TABLE(link_attrs),
+	.out_size = sizeof(struct nlmon_link_info),
+	.finish = link_finish,
+};
+
+/* Address messages */
+
+static const struct nlmon_nl_hdr_desc addr_hdr[] = {
+	NL_HDR(struct ifaddrmsg, ifa_family, struct nlmon_addr_info, family),
+	NL_HDR(struct ifaddrmsg, ifa_index, struct nlmon_addr_info, ifindex),
+	NL_HDR(struct ifaddrmsg, ifa_prefixlen, struct nlmon_addr_info, prefixlen),
+	NL_HDR(struct ifaddrmsg, ifa_scope, struct nlmon_addr_info, scope),
+};
+
+static const struct nlmon_nl_attr_desc addr_attrs[IFA_LABEL + 1] = {
+	[IFA_ADDRESS] = NL_ATTR(struct nlmon_addr_info, addr, NLMON_NL_ATTR_ADDR),
+	[IFA_LABEL] = NL_ATTR(struct nlmon_addr_info, label, NLMON_NL_ATTR_STRING),
+};
+
+static void addr_finish(const struct nlmsghdr *nlh, void *out)
+{
+	struct nlmon_addr_info *addr_info = out;
+	
+	(void)nlh;
+	
+	/* Fallback to if_indextoname if label not in attributes */
+	if (addr_info->label[0] == '\0')
+		if_indextoname(addr_info->ifindex, addr_info->label);
+}
+
+const struct nlmon_nl_decode_table nlmon_nl_addr_decoder = {
+	.hdrlen = sizeof(struct ifaddrmsg),
+	.hdr = addr_hdr,
+	.nhdr = sizeof(addr_hdr) / sizeof(addr_hdr[0]),
+	.attrs = NL_TABLE(addr_attrs),
+	.out_size = sizeof(struct nlmon_addr_info),
+	.finish = addr_finish,
+};
+
+/* Route messages */
+
+static const struct nlmon_nl_hdr_desc route_hdr[] = {
+	NL_HDR(struct rtmsg, rtm_family, struct nlmon_route_info, family),
+	NL_HDR(struct rtmsg, rtm_dst_len, struct nlmon_route_info, dst_len),
+	NL_HDR(struct rtmsg, rtm_src_len, struct nlmon_route_info, src_len),
+	NL_HDR(struct rtmsg, rtm_tos, struct nlmon_route_info, tos),
+	NL_HDR(struct rtmsg, rtm_protocol, struct nlmon_route_info, protocol),
+	NL_HDR(struct rtmsg, rtm_scope, struct nlmon_route_info, scope),
+	NL_HDR(struct rtmsg, rtm_type, struct nlmon_route_info, type),
+	NL_HDR(struct rtmsg, rtm_table, struct nlmon_route_info, table),
+};
+
+static const struct nlmon_nl_attr_desc route_attrs[RTA_TABLE + 1] = {
+	[RTA_DST] = NL_ATTR(struct nlmon_route_info, dst, NLMON_NL_ATTR_ADDR),
+	[RTA_SRC] = NL_ATTR(struct nlmon_route_info, src, NLMON_NL_ATTR_ADDR),
+	[RTA_OIF] = NL_ATTR(struct nlmon_route_info, oif, NLMON_NL_ATTR_U32),
+	[RTA_GATEWAY] = NL_ATTR(struct nlmon_route_info, gateway, NLMON_NL_ATTR_ADDR),
+	[RTA_PRIORITY] = NL_ATTR(struct nlmon_route_info, priority, NLMON_NL_ATTR_U32),
+	[RTA_TABLE] = NL_ATTR(struct nlmon_route_info, table, NLMON_NL_ATTR_U32),
+};
+
+const struct nlmon_nl_decode_table nlmon_nl_route_decoder = {
+	.hdrlen = sizeof(struct rtmsg),
+	.hdr = route_hdr,
+	.nhdr = sizeof(route_hdr) / sizeof(route_hdr[0]),
+	.attrs = NL_TABLE(route_attrs),
+	.out_size = sizeof(struct nlmon_route_info),
+};
+
+/* Neighbor messages */
+
+static const struct nlmon_nl_hdr_desc neigh_hdr[] = {
+	NL_HDR(struct ndmsg, ndm_family, struct nlmon_neigh_info, family),
+	NL_HDR(struct ndmsg, ndm_ifindex, struct nlmon_neigh_info, ifindex),
+	NL_HDR(struct ndmsg, ndm_state, struct nlmon_neigh_info, state),
+	NL_HDR(struct ndmsg, ndm_flags, struct nlmon_neigh_info, flags),
+};
+
+static const struct nlmon_nl_attr_desc neigh_attrs[NDA_LLADDR + 1] = {
+	[NDA_DST] = NL_ATTR(struct nlmon_neigh_info, dst, NLMON_NL_ATTR_ADDR),
+	[NDA_LLADDR] = NL_ATTR(struct nlmon_neigh_info, lladdr, NLMON_NL_ATTR_BINARY),
+};
+
+const struct nlmon_nl_decode_table nlmon_nl_neigh_decoder = {
+	.hdrlen = sizeof(struct ndmsg),
+	.hdr = neigh_hdr,
+	.nhdr = sizeof(neigh_hdr) / sizeof(neigh_hdr[0]),
+	.attrs = NL_TABLE(neigh_attrs),
+	.out_size = sizeof(struct nlmon_neigh_info),
+};
+
+/* Conntrack messages, offsets of nested tables are relative to the parent */
+
+#define CT_REL(field, base) \
+	(uint16_t)(offsetof(struct nlmon_ct_info, field) - offsetof(struct nlmon_ct_info, base))
+
+#define CT_ATTR(field, base, k) \
+	{ CT_REL(field, base), sizeof(((struct nlmon_ct_info *)0)->field), (k), NULL }
+
+#define CT_NEST(field, base, table) \
+	{ CT_REL(field, base), 0, NLMON_NL_ATTR_NESTED, (table) }
+
+static const struct nlmon_nl_attr_desc ct_ip_attrs[CTA_IP_V6_DST + 1] = {
+	[CTA_IP_V4_SRC] = CT_ATTR(src_addr, src_addr, NLMON_NL_ATTR_ADDR4),
+	[CTA_IP_V4_DST] = CT_ATTR(dst_addr, src_addr, NLMON_NL_ATTR_ADDR4),
+	[CTA_IP_V6_SRC] = CT_ATTR(src_addr, src_addr, NLMON_NL_ATTR_ADDR6),
+	[CTA_IP_V6_DST] = CT_ATTR(dst_addr, src_addr, NLMON_NL_ATTR_ADDR6),
+};
+
+static const struct nlmon_nl_attr_table ct_ip_table = NL_TABLE(ct_ip_attrs);
+
+static const struct nlmon_nl_attr_desc ct_proto_attrs[CTA_PROTO_DST_PORT + 1] = {
+	[CTA_PROTO_NUM] = CT_ATTR(protocol, protocol, NLMON_NL_ATTR_U8),
+	[CTA_PROTO_SRC_PORT] = CT_ATTR(src_port, protocol, NLMON_NL_ATTR_BE16),
+	[CTA_PROTO_DST_PORT] = CT_ATTR(dst_port, protocol, NLMON_NL_ATTR_BE16),
+};
+
+static const struct nlmon_nl_attr_table ct_proto_table = NL_TABLE(ct_proto_attrs);
+
+static const struct nlmon_nl_attr_desc ct_tuple_attrs[CTA_TUPLE_PROTO + 1] = {
+	[CTA_TUPLE_IP] = CT_NEST(src_addr, protocol, &ct_ip_table),
+	[CTA_TUPLE_PROTO] = CT_NEST(protocol, protocol, &ct_proto_table),
+};
+
+static const struct nlmon_nl_attr_table ct_tuple_table = NL_TABLE(ct_tuple_attrs);
+
+static const struct nlmon_nl_attr_desc ct_tcp_attrs[CTA_PROTOINFO_TCP_STATE + 1] = {
+	[CTA_PROTOINFO_TCP_STATE] = CT_ATTR(tcp_state, tcp_state, NLMON_NL_ATTR_U8),
+};
+
+static const struct nlmon_nl_attr_table ct_tcp_table = NL_TABLE(ct_tcp_attrs);
+
+static const struct nlmon_nl_attr_desc ct_protoinfo_attrs[CTA_PROTOINFO_TCP + 1] = {
+	[CTA_PROTOINFO_TCP] = CT_NEST(tcp_state, tcp_state, &ct_tcp_table),
+};
+
+static const struct nlmon_nl_attr_table ct_protoinfo_table = NL_TABLE(ct_protoinfo_attrs);
+
+/* Same table for both directions, based at packets_orig or packets_reply */
+static const struct nlmon_nl_attr_desc ct_counters_attrs[CTA_COUNTERS_BYTES + 1] = {
+	[CTA_COUNTERS_PACKETS] = CT_ATTR(packets_orig, packets_orig, NLMON_NL_ATTR_BE64),
+	[CTA_COUNTERS_BYTES] = CT_ATTR(bytes_orig, packets_orig, NLMON_NL_ATTR_BE64),
+};
+
+static const struct nlmon_nl_attr_table ct_counters_table = NL_TABLE(ct_counters_attrs);
+
+_Static_assert(offsetof(struct nlmon_ct_info, bytes_reply) - offsetof(struct nlmon_ct_info, packets_reply) ==
+               offsetof(struct nlmon_ct_info, bytes_orig) - offsetof(struct nlmon_ct_info, packets_orig),
+               "conntrack counter layout");
+
+static const struct nlmon_nl_attr_desc ct_attrs[CTA_COUNTERS_REPLY + 1] = {
+	[CTA_TUPLE_ORIG] = NL_NEST(struct nlmon_ct_info, protocol, &ct_tuple_table),
+	[CTA_PROTOINFO] = NL_NEST(struct nlmon_ct_info, tcp_state, &ct_protoinfo_table),
+	[CTA_MARK] = NL_ATTR(struct nlmon_ct_info, mark, NLMON_NL_ATTR_BE32),
+	[CTA_COUNTERS_ORIG] = NL_NEST(struct nlmon_ct_info, packets_orig, &ct_counters_table),
+	[CTA_COUNTERS_REPLY] = NL_NEST(struct nlmon_ct_info, packets_reply, &ct_counters_table),
+};
+
+const struct nlmon_nl_decode_table nlmon_nl_ct_decoder = {
+	.hdrlen = sizeof(struct nfgenmsg),
+	.attrs = NL_TABLE(ct_attrs),
+	.out_size = sizeof(struct nlmon_ct_info),
+};
+
+/**
+ * Find the decoder of a message type
+ */
+const struct nlmon_nl_decode_table *nlmon_nl_decoder_lookup(int protocol, uint16_t msg_type)
+{
+	const struct nlmon_nl_msg_desc *desc = nlmon_nl_msg_lookup(protocol, msg_type);
+	
+	return desc ? desc->decoder : NULL;
+}
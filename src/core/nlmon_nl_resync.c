@@ -0,0 +1,701 @@
+/* nlmon_nl_resync.c - ENOBUFS-aware NETLINK_ROUTE resynchronization
+ *
+ * When a netlink socket overruns its receive buffer the kernel drops
+ * notifications and reports ENOBUFS. Instead of restarting, the manager
+ * keeps the last known link/address/route state, dumps the current state
+ * over a private socket after an overrun and emits only the differences
+ * as synthetic events.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <netlink/netlink.h>
+#include <netlink/socket.h>
+#include <netlink/msg.h>
+#include <netlink/handlers.h>
+
+#include "nlmon_netlink.h"
+#include "nlmon_nl_resync.h"
+#include "nlmon_nl_route.h"
+#include "nlmon_nl_limits.h"
+#include "nlmon_nl_error.h"
+#include "event_processor.h"
+
+#define STATE_HASH_SIZE        1024      /* Buckets, power of two */
+#define RESYNC_SOCK_RCVBUF     (1024 * 1024)
+#define RESYNC_MAX_RETRIES     3         /* Retries for interrupted dumps */
+#define RESYNC_TIMEOUT_SEC     2         /* Per-receive dump timeout */
+
+/* Object identity, zero-filled so it can be hashed and compared bytewise */
+struct state_key {
+	uint8_t kind;
+	uint8_t family;
+	uint8_t prefixlen;
+	uint8_t tos;
+	int ifindex;                     /* Link/address ifindex, route oif */
+	uint32_t priority;
+	uint32_t table;                  /* Route table, VRFs and policy routing reuse prefixes */
+	uint32_t type;                   /* Route type, blackhole and unicast may share one */
+	char addr[64];                   /* Address or route destination */
+};
+
+struct state_entry {
+	struct state_key key;
+	uint64_t generation;             /* Last dump that confirmed the object */
+	struct state_entry *next;
+	union {
+		struct nlmon_link_info link;
+		struct nlmon_addr_info addr;
+		struct nlmon_route_info route;
+	} info;
+};
+
+struct nlmon_nl_state {
+	struct state_entry *buckets[STATE_HASH_SIZE];
+	uint64_t count;
+	uint64_t generation;
+	pthread_mutex_t lock;
+};
+
+/* Dump context for the private resync socket */
+struct resync_ctx {
+	struct nlmon_nl_manager *mgr;
+	uint64_t generation;
+	int emit;                        /* Emit deltas (0 while seeding) */
+	int done;
+	int interrupted;                 /* NLM_F_DUMP_INTR seen */
+	int events;
+};
+
+static const struct {
+	int kind;
+	int dump_type;
+	int new_type;
+	int del_type;
+	size_t hdrlen;
+} resync_kinds[NLMON_NL_STATE_KIND_COUNT] = {
+	[NLMON_NL_STATE_LINK]  = { NLMON_NL_STATE_LINK,  RTM_GETLINK,  RTM_NEWLINK,  RTM_DELLINK,
+	                           sizeof(struct ifinfomsg) },
+	[NLMON_NL_STATE_ADDR]  = { NLMON_NL_STATE_ADDR,  RTM_GETADDR,  RTM_NEWADDR,  RTM_DELADDR,
+	                           sizeof(struct ifaddrmsg) },
+	[NLMON_NL_STATE_ROUTE] = { NLMON_NL_STATE_ROUTE, RTM_GETROUTE, RTM_NEWROUTE, RTM_DELROUTE,
+	                           sizeof(struct rtmsg) },
+};
+
+/**
+ * Map a route message type to a state kind
+ */
+static int state_kind_of(uint16_t msg_type, int *is_del)
+{
+	switch (msg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		*is_del = msg_type == RTM_DELLINK;
+		return NLMON_NL_STATE_LINK;
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		*is_del = msg_type == RTM_DELADDR;
+		return NLMON_NL_STATE_ADDR;
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE:
+		*is_del = msg_type == RTM_DELROUTE;
+		return NLMON_NL_STATE_ROUTE;
+	default:
+		return -1;
+	}
+}
+
+/**
+ * Build the identity key of an event's object
+ */
+static int state_key_from_event(const struct nlmon_event *evt, struct state_key *key,
+                                int *is_del)
+{
+	int kind;
+	
+	if (!evt || !evt->netlink.data.generic || evt->netlink.protocol != NETLINK_ROUTE)
+		return -1;
+	
+	kind = state_kind_of(evt->netlink.msg_type, is_del);
+	if (kind < 0)
+		return -1;
+	
+	memset(key, 0, sizeof(*key));
+	key->kind = (uint8_t)kind;
+	
+	switch (kind) {
+	case NLMON_NL_STATE_LINK:
+		key->ifindex = evt->netlink.data.link->ifindex;
+		break;
+	case NLMON_NL_STATE_ADDR:
+		key->family = (uint8_t)evt->netlink.data.addr->family;
+		key->ifindex = evt->netlink.data.addr->ifindex;
+		key->prefixlen = evt->netlink.data.addr->prefixlen;
+		memcpy(key->addr, evt->netlink.data.addr->addr, sizeof(key->addr));
+		break;
+	case NLMON_NL_STATE_ROUTE:
+		key->family = (uint8_t)evt->netlink.data.route->family;
+		key->ifindex = evt->netlink.data.route->oif;
+		key->prefixlen = evt->netlink.data.route->dst_len;
+		key->tos = evt->netlink.data.route->tos;
+		key->priority = evt->netlink.data.route->priority;
+		key->table = evt->netlink.data.route->table;
+		key->type = evt->netlink.data.route->type;
+		memcpy(key->addr, evt->netlink.data.route->dst, sizeof(key->addr));
+		break;
+	}
+	
+	/* Parsers fill strings with strncpy, keep only the terminated part */
+	key->addr[sizeof(key->addr) - 1] = '\0';
+	memset(key->addr + strlen(key->addr), 0, sizeof(key->addr) - strlen(key->addr));
+	
+	return kind;
+}
+
+static size_t state_info_size(int kind)
+{
+	switch (kind) {
+	case NLMON_NL_STATE_LINK:
+		return sizeof(struct nlmon_link_info);
+	case NLMON_NL_STATE_ADDR:
+		return sizeof(struct nlmon_addr_info);
+	default:
+		return sizeof(struct nlmon_route_info);
+	}
+}
+
+/* FNV-1a over the key bytes */
+static uint32_t state_hash(const struct state_key *key)
+{
+	const uint8_t *p = (const uint8_t *)key;
+	uint32_t h = 2166136261u;
+	size_t i;
+	
+	for (i = 0; i < sizeof(*key); i++) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+	
+	return h & (STATE_HASH_SIZE - 1);
+}
+
+static struct state_entry **state_find(struct nlmon_nl_state *state,
+                                       const struct state_key *key)
+{
+	struct state_entry **pp = &state->buckets[state_hash(key)];
+	
+	while (*pp && memcmp(&(*pp)->key, key, sizeof(*key)) != 0)
+		pp = &(*pp)->next;
+	
+	return pp;
+}
+
+/**
+ * Insert or update an object
+ *
+ * Returns: 1 if the object was added or changed, 0 if unchanged, -1 on error
+ */
+static int state_upsert(struct nlmon_nl_state *state, const struct state_key *key,
+                        const void *info, uint64_t generation)
+{
+	struct state_entry **pp = state_find(state, key);
+	struct state_entry *entry = *pp;
+	size_t size = state_info_size(key->kind);
+	
+	if (entry) {
+		entry->generation = generation;
+		if (memcmp(&entry->info, info, size) == 0)
+			return 0;
+		memcpy(&entry->info, info, size);
+		return 1;
+	}
+	
+	entry = calloc(1, sizeof(*entry));
+	if (!entry)
+		return -1;
+	
+	entry->key = *key;
+	entry->generation = generation;
+	memcpy(&entry->info, info, size);
+	*pp = entry;
+	state->count++;
+	
+	return 1;
+}
+
+/**
+ * Create state table
+ */
+struct nlmon_nl_state *nlmon_nl_state_create(void)
+{
+	struct nlmon_nl_state *state;
+	
+	state = calloc(1, sizeof(*state));
+	if (!state)
+		return NULL;
+	
+	if (pthread_mutex_init(&state->lock, NULL) != 0) {
+		free(state);
+		return NULL;
+	}
+	
+	return state;
+}
+
+/**
+ * Destroy state table
+ */
+void nlmon_nl_state_destroy(struct nlmon_nl_state *state)
+{
+	struct state_entry *entry, *next;
+	int i;
+	
+	if (!state)
+		return;
+	
+	for (i = 0; i < STATE_HASH_SIZE; i++) {
+		for (entry = state->buckets[i]; entry; entry = next) {
+			next = entry->next;
+			free(entry);
+		}
+	}
+	
+	pthread_mutex_destroy(&state->lock);
+	free(state);
+}
+
+/**
+ * Apply a live event to the state table
+ */
+void nlmon_nl_state_apply(struct nlmon_nl_state *state, const struct nlmon_event *evt)
+{
+	struct state_key key;
+	struct state_entry **pp, *entry;
+	int is_del = 0;
+	
+	if (!state || state_key_from_event(evt, &key, &is_del) < 0)
+		return;
+	
+	pthread_mutex_lock(&state->lock);
+	
+	if (is_del) {
+		pp = state_find(state, &key);
+		entry = *pp;
+		if (entry) {
+			*pp = entry->next;
+			state->count--;
+			free(entry);
+		}
+	} else {
+		state_upsert(state, &key, evt->netlink.data.generic, state->generation);
+	}
+	
+	pthread_mutex_unlock(&state->lock);
+}
+
+/**
+ * Get number of tracked objects
+ */
+uint64_t nlmon_nl_state_count(struct nlmon_nl_state *state)
+{
+	uint64_t count;
+	
+	if (!state)
+		return 0;
+	
+	pthread_mutex_lock(&state->lock);
+	count = state->count;
+	pthread_mutex_unlock(&state->lock);
+	
+	return count;
+}
+
+/**
+ * Hand a synthetic event to the manager's callback
+ */
+static void resync_emit(struct nlmon_nl_manager *mgr, struct nlmon_event *evt)
+{
+	if (mgr->event_callback)
+		mgr->event_callback(evt, mgr->user_data);
+	mgr->resync_stats.delta_events++;
+}
+
+/**
+ * Dump message handler for the private resync socket
+ */
+static int resync_valid_handler(struct nl_msg *msg, void *arg)
+{
+	struct resync_ctx *ctx = arg;
+	struct nlmsghdr *nlh = nlmsg_hdr(msg);
+	struct nlmon_nl_state *state = ctx->mgr->state;
+	struct nlmon_event evt;
+	struct state_key key;
+	int is_del = 0;
+	int ret, changed;
+	
+	if (nlh->nlmsg_flags & NLM_F_DUMP_INTR)
+		ctx->interrupted = 1;
+	
+	memset(&evt, 0, sizeof(evt));
+	evt.timestamp = nlmon_nl_recv_timestamp();
+	evt.netlink.protocol = NETLINK_ROUTE;
+	evt.netlink.msg_type = nlh->nlmsg_type;
+	evt.netlink.msg_flags = nlh->nlmsg_flags;
+	evt.netlink.seq = nlh->nlmsg_seq;
+	evt.netlink.pid = nlh->nlmsg_pid;
+	evt.event_type = nlh->nlmsg_type;
+	
+	switch (nlh->nlmsg_type) {
+	case RTM_NEWLINK:
+		ret = nlmon_parse_link_msg(nlh, &evt);
+		break;
+	case RTM_NEWADDR:
+		ret = nlmon_parse_addr_msg(nlh, &evt);
+		break;
+	case RTM_NEWROUTE:
+		ret = nlmon_parse_route_msg(nlh, &evt);
+		break;
+	default:
+		return NL_SKIP;
+	}
+	
+	if (ret < 0 || state_key_from_event(&evt, &key, &is_del) < 0) {
+		free(evt.netlink.data.generic);
+		return NL_SKIP;
+	}
+	
+	pthread_mutex_lock(&state->lock);
+	changed = state_upsert(state, &key, evt.netlink.data.generic, ctx->generation);
+	pthread_mutex_unlock(&state->lock);
+	
+	/* Only new or changed objects are reported */
+	if (changed > 0 && ctx->emit) {
+		resync_emit(ctx->mgr, &evt);
+		ctx->events++;
+	}
+	
+	free(evt.netlink.data.generic);
+	return NL_OK;
+}
+
+static int resync_finish_handler(struct nl_msg *msg, void *arg)
+{
+	struct resync_ctx *ctx = arg;
+	
+	(void)msg;
+	ctx->done = 1;
+	return NL_STOP;
+}
+
+/**
+ * Remove objects of a kind not confirmed by the dump of @generation
+ *
+ * Stale entries are unlinked under the lock and reported afterwards so
+ * the callback never runs with the state table locked.
+ */
+static int resync_sweep(struct resync_ctx *ctx, int kind)
+{
+	struct nlmon_nl_state *state = ctx->mgr->state;
+	struct state_entry *stale = NULL, *entry, **pp;
+	struct nlmon_event evt;
+	int i, events = 0;
+	
+	pthread_mutex_lock(&state->lock);
+	for (i = 0; i < STATE_HASH_SIZE; i++) {
+		pp = &state->buckets[i];
+		while ((entry = *pp) != NULL) {
+			if (entry->key.kind == kind && entry->generation < ctx->generation) {
+				*pp = entry->next;
+				entry->next = stale;
+				stale = entry;
+				state->count--;
+			} else {
+				pp = &entry->next;
+			}
+		}
+	}
+	pthread_mutex_unlock(&state->lock);
+	
+	while ((entry = stale) != NULL) {
+		stale = entry->next;
+	
+		if (ctx->emit) {
+			memset(&evt, 0, sizeof(evt));
+			evt.timestamp = nlmon_nl_recv_timestamp();
+			evt.netlink.protocol = NETLINK_ROUTE;
+			evt.netlink.msg_type = resync_kinds[kind].del_type;
+			evt.event_type = evt.netlink.msg_type;
+			evt.netlink.data.generic = &entry->info;
+	
+			resync_emit(ctx->mgr, &evt);
+			events++;
+		}
+	
+		free(entry);
+	}
+	
+	return events;
+}
+
+/**
+ * Dump one object class over @sk and diff it against the state table
+ */
+static int resync_kind(struct nl_sock *sk, struct nl_cb *cb,
+                       struct resync_ctx *ctx, int kind)
+{
+	union {
+		struct ifinfomsg ifi;
+		struct ifaddrmsg ifa;
+		struct rtmsg rtm;
+	} req;
+	int attempt, ret;
+	
+	/* Dump requests only need the family, which leads every header */
+	memset(&req, 0, sizeof(req));
+	req.ifi.ifi_family = AF_UNSPEC;
+	
+	for (attempt = 0; attempt < RESYNC_MAX_RETRIES; attempt++) {
+		pthread_mutex_lock(&ctx->mgr->state->lock);
+		ctx->generation = ++ctx->mgr->state->generation;
+		pthread_mutex_unlock(&ctx->mgr->state->lock);
+	
+		ctx->done = 0;
+		ctx->interrupted = 0;
+	
+		ret = nl_send_simple(sk, resync_kinds[kind].dump_type, NLM_F_DUMP,
+		                     &req, resync_kinds[kind].hdrlen);
+		if (ret < 0)
+			return ret;
+	
+		while (!ctx->done) {
+			errno = 0;
+			ret = nl_recvmsgs(sk, cb);
+			if (ret < 0)
+				return ret;
+			
+			/* Receive timed out before NLMSG_DONE */
+			if (!ctx->done && (errno == EAGAIN || errno == EWOULDBLOCK))
+				return -ETIMEDOUT;
+		}
+	
+		/* Dump raced with changes, objects may be missing - retry */
+		if (!ctx->interrupted)
+			break;
+	}
+	
+	if (ctx->interrupted)
+		return -EAGAIN;
+	
+	ctx->events += resync_sweep(ctx, kind);
+	return 0;
+}
+
+/**
+ * Run a dump-and-diff pass over the requested classes
+ */
+static int resync_run(struct nlmon_nl_manager *mgr, unsigned int mask, int emit)
+{
+	struct timeval timeout = { .tv_sec = RESYNC_TIMEOUT_SEC };
+	struct resync_ctx ctx;
+	struct nl_sock *sk;
+	struct nl_cb *cb;
+	int kind, ret = 0;
+	
+	if (!mgr || !mgr->state)
+		return -EINVAL;
+	
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.mgr = mgr;
+	ctx.emit = emit;
+	
+	/* Private blocking socket so dump replies never mix with notifications */
+	sk = nl_socket_alloc();
+	if (!sk)
+		return -ENOMEM;
+	
+	ret = nl_connect(sk, NETLINK_ROUTE);
+	if (ret < 0) {
+		nl_socket_free(sk);
+		return ret;
+	}
+	nl_socket_set_buffer_size(sk, RESYNC_SOCK_RCVBUF, 0);
+	
+	/* Never stall the receive path on a dump the kernel abandoned */
+	setsockopt(nl_socket_get_fd(sk), SOL_SOCKET, SO_RCVTIMEO,
+	           &timeout, sizeof(timeout));
+	
+	cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (!cb) {
+		nl_close(sk);
+		nl_socket_free(sk);
+		return -ENOMEM;
+	}
+	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, resync_valid_handler, &ctx);
+	nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, resync_finish_handler, &ctx);
+	
+	for (kind = 0; kind < NLMON_NL_STATE_KIND_COUNT; kind++) {
+		if (!(mask & (1u << kind)))
+			continue;
+	
+		ret = resync_kind(sk, cb, &ctx, kind);
+		if (ret < 0)
+			break;
+	}
+	
+	nl_cb_put(cb);
+	nl_close(sk);
+	nl_socket_free(sk);
+	
+	if (ret < 0) {
+		mgr->resync_stats.resync_failures++;
+		nlmon_nl_log_error("NETLINK_ROUTE resynchronization failed", ret);
+		return ret;
+	}
+	
+	if (emit)
+		mgr->resync_stats.resyncs++;
+	
+	return ctx.events;
+}
+
+/**
+ * Enable ENOBUFS-aware resynchronization
+ */
+int nlmon_nl_enable_resync(struct nlmon_nl_manager *mgr)
+{
+	int ret;
+	
+	if (!mgr)
+		return -EINVAL;
+	
+	if (!mgr->route_sock || !mgr->enable_route)
+		return -ENOTCONN;
+	
+	if (mgr->state)
+		return 0;
+	
+	mgr->state = nlmon_nl_state_create();
+	if (!mgr->state)
+		return -ENOMEM;
+	
+	/* Seed the baseline without reporting anything */
+	ret = resync_run(mgr, NLMON_NL_RESYNC_ALL, 0);
+	if (ret < 0) {
+		nlmon_nl_state_destroy(mgr->state);
+		mgr->state = NULL;
+		return ret;
+	}
+	
+	return 0;
+}
+
+/**
+ * Disable resynchronization
+ */
+void nlmon_nl_disable_resync(struct nlmon_nl_manager *mgr)
+{
+	if (!mgr || !mgr->state)
+		return;
+	
+	nlmon_nl_state_destroy(mgr->state);
+	mgr->state = NULL;
+}
+
+/**
+ * Resynchronize NETLINK_ROUTE state
+ */
+int nlmon_nl_resync(struct nlmon_nl_manager *mgr, unsigned int mask)
+{
+	if (!mgr || !mgr->state)
+		return -EINVAL;
+	
+	return resync_run(mgr, mask & NLMON_NL_RESYNC_ALL, 1);
+}
+
+/**
+ * Account an overrun in the limits tracker
+ *
+ * Updates the socket buffer stats and lets the autotuner grow the
+ * receive buffer so the next burst fits.
+ */
+static void overrun_update_limits(struct nlmon_nl_manager *mgr, struct nl_sock *sk)
+{
+	if (!mgr->limits || !sk)
+		return;
+	
+	nlmon_nl_limits_autotune(mgr->limits, nl_socket_get_fd(sk), true);
+}
+
+/**
+ * Handle a receive buffer overrun
+ */
+int nlmon_nl_handle_overrun(struct nlmon_nl_manager *mgr, int protocol)
+{
+	struct nl_sock *sk;
+	int ret;
+	
+	if (!mgr)
+		return -EINVAL;
+	
+	mgr->resync_stats.overruns++;
+	
+	switch (protocol) {
+	case NETLINK_ROUTE:
+		mgr->resync_stats.route_overruns++;
+		sk = mgr->route_sock;
+		break;
+	case NETLINK_GENERIC:
+		mgr->resync_stats.genl_overruns++;
+		sk = mgr->genl_sock;
+		break;
+	case NETLINK_SOCK_DIAG:
+		mgr->resync_stats.diag_overruns++;
+		sk = mgr->diag_sock;
+		break;
+	case NETLINK_NETFILTER:
+		mgr->resync_stats.nf_overruns++;
+		sk = mgr->nf_sock;
+		break;
+	default:
+		return -EINVAL;
+	}
+	
+	overrun_update_limits(mgr, sk);
+	
+	/* Only NETLINK_ROUTE has dumpable state to diff against */
+	if (protocol != NETLINK_ROUTE || !mgr->state)
+		return 0;
+	
+	ret = nlmon_nl_resync(mgr, NLMON_NL_RESYNC_ALL);
+	return ret < 0 ? ret : 0;
+}
+
+/**
+ * Get resynchronization statistics
+ */
+void nlmon_nl_get_resync_stats(struct nlmon_nl_manager *mgr,
+                               struct nlmon_nl_resync_stats *stats)
+{
+	if (!stats)
+		return;
+	
+	memset(stats, 0, sizeof(*stats));
+	if (!mgr)
+		return;
+	
+	*stats = mgr->resync_stats;
+	stats->objects = nlmon_nl_state_count(mgr->state);
+}
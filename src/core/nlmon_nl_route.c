@@ -20,8 +20,21 @@
 
 #include "nlmon_netlink.h"
 #include "nlmon_nl_route.h"
+#include "nlmon_nl_dispatch.h"
 #include "event_processor.h"
 
+/* Index or decode a message according to the manager's decode mode */
+static int route_parse(struct nlmon_nl_manager *mgr, struct nlmsghdr *nlh,
+                       struct nlmon_event *evt, struct nlmon_nl_route_lazy *lazy,
+                       int (*parse)(struct nlmsghdr *, struct nlmon_event *))
+{
+	/* Messages the index cannot cover fall back to a full decode */
+	if (mgr->lazy_decode && nlmon_defer_route_msg(nlh, evt, lazy) == 0)
+		return 0;
+	
+	return parse(nlh, evt);
+}
+
 /**
  * Route message callback handler
  * 
@@ -32,6 +45,8 @@ int nlmon_route_msg_handler(struct nl_msg *msg, void *arg)
 {
 	struct nlmon_nl_manager *mgr = (struct nlmon_nl_manager *)arg;
 	struct nlmsghdr *nlh = nlmsg_hdr(msg);
+	const struct nlmon_nl_msg_desc *desc;
+	struct nlmon_nl_route_lazy lazy;
 	struct nlmon_event evt;
 	int ret = 0;
 	
@@ -40,62 +55,36 @@ int nlmon_route_msg_handler(struct nl_msg *msg, void *arg)
 	
 	/* Initialize event structure */
 	memset(&evt, 0, sizeof(evt));
-	evt.timestamp = time(NULL) * 1000000000ULL; /* Convert to nanoseconds */
+	evt.timestamp = nlmon_nl_recv_timestamp();
 	evt.netlink.protocol = NETLINK_ROUTE;
 	evt.netlink.msg_type = nlh->nlmsg_type;
 	evt.netlink.msg_flags = nlh->nlmsg_flags;
 	evt.netlink.seq = nlh->nlmsg_seq;
 	evt.netlink.pid = nlh->nlmsg_pid;
 	
-	/* Route to appropriate parser based on message type */
-	switch (nlh->nlmsg_type) {
-	case RTM_NEWLINK:
-	case RTM_DELLINK:
-		/* Update link cache if enabled */
-		nlmon_nl_cache_update_link(mgr, msg);
-		
-		ret = nlmon_parse_link_msg(nlh, &evt);
-		evt.event_type = nlh->nlmsg_type;
-		break;
-		
-	case RTM_NEWADDR:
-	case RTM_DELADDR:
-		/* Update address cache if enabled */
-		nlmon_nl_cache_update_addr(mgr, msg);
-		
-		ret = nlmon_parse_addr_msg(nlh, &evt);
-		evt.event_type = nlh->nlmsg_type;
-		break;
-		
-	case RTM_NEWROUTE:
-	case RTM_DELROUTE:
-		/* Update route cache if enabled */
-		nlmon_nl_cache_update_route(mgr, msg);
-		
-		ret = nlmon_parse_route_msg(nlh, &evt);
-		evt.event_type = nlh->nlmsg_type;
-		break;
-		
-	case RTM_NEWNEIGH:
-	case RTM_DELNEIGH:
-		ret = nlmon_parse_neigh_msg(nlh, &evt);
-		evt.event_type = nlh->nlmsg_type;
-		break;
-		
-	case NLMSG_DONE:
+	if (nlh->nlmsg_type == NLMSG_DONE) {
 		/* End of multipart message */
 		return NL_STOP;
-		
-	case NLMSG_ERROR:
+	}
+	
+	if (nlh->nlmsg_type == NLMSG_ERROR) {
 		/* Error message */
 		fprintf(stderr, "Received NLMSG_ERROR in route handler\n");
 		return NL_STOP;
-		
-	default:
-		/* Unknown or unhandled message type */
-		return NL_SKIP;
 	}
 	
+	/* Unknown or unhandled message types, and echoed dump requests */
+	desc = nlmon_nl_msg_lookup(NETLINK_ROUTE, nlh->nlmsg_type);
+	if (!desc || !(desc->subscribers & NLMON_NL_SUB_EVENTS))
+		return NL_SKIP;
+	
+	/* Update the object cache if enabled */
+	if (desc->cache_update)
+		desc->cache_update(mgr, msg);
+	
+	ret = route_parse(mgr, nlh, &evt, &lazy, desc->parse);
+	evt.event_type = nlh->nlmsg_type;
+	
 	/* If parsing failed, skip this message */
 	if (ret < 0) {
 		fprintf(stderr, "Failed to parse route message type %d: %d\n",
@@ -103,11 +92,15 @@ int nlmon_route_msg_handler(struct nl_msg *msg, void *arg)
 		return NL_SKIP;
 	}
 	
-	/* Forward event to nlmon event processor if callback is set */
-	if (mgr->event_callback) {
-		mgr->event_callback(&evt, mgr->user_data);
+	/* Keep the resync baseline current, it stores decoded objects */
+	if (mgr->state && (desc->subscribers & NLMON_NL_SUB_STATE)) {
+		nlmon_event_materialize(&evt);
+		nlmon_nl_state_apply(mgr->state, &evt);
 	}
 	
+	/* Forward event to nlmon event processor if callback is set */
+	nlmon_nl_deliver_event(mgr, &evt);
+	
 	/* Free any allocated data in the event */
 	if (evt.netlink.data.generic) {
 		free(evt.netlink.data.generic);
@@ -117,32 +110,43 @@ int nlmon_route_msg_handler(struct nl_msg *msg, void *arg)
 	return NL_OK;
 }
 
-/**
- * Parse link (interface) message
- * 
- * Extracts interface information from RTM_NEWLINK/RTM_DELLINK messages.
+/*
+ * Fixed size attributes the decoders read, checked before use. The
+ * others are bounded by the decoders themselves and skip validation.
  */
-int nlmon_parse_link_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
+static const struct nla_policy link_policy[IFLA_MAX + 1] = {
+	[IFLA_MTU] = { .type = NLA_U32 },
+	[IFLA_OPERSTATE] = { .type = NLA_U8 },
+};
+
+static const struct nla_policy route_policy[RTA_MAX + 1] = {
+	[RTA_TABLE] = { .type = NLA_U32 },
+	[RTA_OIF] = { .type = NLA_U32 },
+	[RTA_PRIORITY] = { .type = NLA_U32 },
+};
+
+/* Attribute types and policy by message class */
+static const struct {
+	int maxtype;
+	const struct nla_policy *policy;
+} route_attrs[MSG_CLASS_OTHER] = {
+	[MSG_CLASS_LINK] = { IFLA_MAX, link_policy },
+	[MSG_CLASS_ADDR] = { IFA_MAX, NULL },
+	[MSG_CLASS_ROUTE] = { RTA_MAX, route_policy },
+	[MSG_CLASS_NEIGH] = { NDA_MAX, NULL },
+};
+
+/* Decode a link (interface) message from its attribute index */
+static int decode_link_msg(struct nlmsghdr *nlh, const struct nla_index *attrs,
+                           struct nlmon_event *evt)
 {
 	struct ifinfomsg *ifi;
-	struct nlattr *tb[IFLA_MAX + 1];
 	struct nlmon_link_info *link_info;
-	int ret;
-	
-	if (!nlh || !evt)
-		return -EINVAL;
+	struct nlattr *nla;
 	
 	/* Get interface info header */
 	ifi = (struct ifinfomsg *)nlmsg_data(nlh);
 	
-	/* Parse attributes */
-	ret = nlmsg_parse(nlh, sizeof(*ifi), tb, IFLA_MAX, NULL);
-	if (ret < 0) {
-		fprintf(stderr, "Failed to parse link message attributes: %s\n",
-		        nl_geterror(ret));
-		return ret;
-	}
-	
 	/* Allocate link info structure */
 	link_info = calloc(1, sizeof(*link_info));
 	if (!link_info)
@@ -155,34 +159,34 @@ int nlmon_parse_link_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 	link_info->flags = ifi->ifi_flags;
 	
 	/* Extract interface name */
-	if (tb[IFLA_IFNAME]) {
-		nla_strlcpy(link_info->ifname, tb[IFLA_IFNAME], IFNAMSIZ);
+	if ((nla = nla_index_get(attrs, IFLA_IFNAME))) {
+		nla_strlcpy(link_info->ifname, nla, IFNAMSIZ);
 	} else {
 		/* Fallback to index-based name */
 		if_indextoname(ifi->ifi_index, link_info->ifname);
 	}
 	
 	/* Extract MTU */
-	if (tb[IFLA_MTU]) {
-		link_info->mtu = nla_get_u32(tb[IFLA_MTU]);
+	if ((nla = nla_index_get(attrs, IFLA_MTU))) {
+		link_info->mtu = nla_get_u32(nla);
 	}
 	
 	/* Extract MAC address */
-	if (tb[IFLA_ADDRESS]) {
-		int addr_len = nla_len(tb[IFLA_ADDRESS]);
+	if ((nla = nla_index_get(attrs, IFLA_ADDRESS))) {
+		int addr_len = nla_len(nla);
 		if (addr_len <= ETH_ALEN) {
-			memcpy(link_info->addr, nla_data(tb[IFLA_ADDRESS]), addr_len);
+			memcpy(link_info->addr, nla_data(nla), addr_len);
 		}
 	}
 	
 	/* Extract qdisc */
-	if (tb[IFLA_QDISC]) {
-		nla_strlcpy(link_info->qdisc, tb[IFLA_QDISC], sizeof(link_info->qdisc));
+	if ((nla = nla_index_get(attrs, IFLA_QDISC))) {
+		nla_strlcpy(link_info->qdisc, nla, sizeof(link_info->qdisc));
 	}
 	
 	/* Extract operational state */
-	if (tb[IFLA_OPERSTATE]) {
-		link_info->operstate = nla_get_u8(tb[IFLA_OPERSTATE]);
+	if ((nla = nla_index_get(attrs, IFLA_OPERSTATE))) {
+		link_info->operstate = nla_get_u8(nla);
 	}
 	
 	/* Store in event */
@@ -193,31 +197,41 @@ int nlmon_parse_link_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 }
 
 /**
- * Parse address message
+ * Parse link (interface) message
  * 
- * Extracts address information from RTM_NEWADDR/RTM_DELADDR messages.
+ * Extracts interface information from RTM_NEWLINK/RTM_DELLINK messages.
  */
-int nlmon_parse_addr_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
+int nlmon_parse_link_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 {
-	struct ifaddrmsg *ifa;
-	struct nlattr *tb[IFA_MAX + 1];
-	struct nlmon_addr_info *addr_info;
+	NLA_INDEX(IFLA_MAX) attrs;
 	int ret;
 	
 	if (!nlh || !evt)
 		return -EINVAL;
 	
-	/* Get address info header */
-	ifa = (struct ifaddrmsg *)nlmsg_data(nlh);
-	
-	/* Parse attributes */
-	ret = nlmsg_parse(nlh, sizeof(*ifa), tb, IFA_MAX, NULL);
+	/* Index attributes */
+	ret = nlmsg_parse_index(nlh, sizeof(struct ifinfomsg), &attrs.hdr, IFLA_MAX,
+	                        route_attrs[MSG_CLASS_LINK].policy, NULL);
 	if (ret < 0) {
-		fprintf(stderr, "Failed to parse address message attributes: %s\n",
+		fprintf(stderr, "Failed to parse link message attributes: %s\n",
 		        nl_geterror(ret));
 		return ret;
 	}
 	
+	return decode_link_msg(nlh, &attrs.hdr, evt);
+}
+
+/* Decode an address message from its attribute index */
+static int decode_addr_msg(struct nlmsghdr *nlh, const struct nla_index *attrs,
+                           struct nlmon_event *evt)
+{
+	struct ifaddrmsg *ifa;
+	struct nlmon_addr_info *addr_info;
+	struct nlattr *nla;
+	
+	/* Get address info header */
+	ifa = (struct ifaddrmsg *)nlmsg_data(nlh);
+	
 	/* Allocate address info structure */
 	addr_info = calloc(1, sizeof(*addr_info));
 	if (!addr_info)
@@ -236,8 +250,8 @@ int nlmon_parse_addr_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 	addr_info->scope = ifa->ifa_scope;
 	
 	/* Extract IP address */
-	if (tb[IFA_ADDRESS]) {
-		void *addr_data = nla_data(tb[IFA_ADDRESS]);
+	if ((nla = nla_index_get(attrs, IFA_ADDRESS))) {
+		void *addr_data = nla_data(nla);
 		
 		if (ifa->ifa_family == AF_INET) {
 			inet_ntop(AF_INET, addr_data, addr_info->addr, sizeof(addr_info->addr));
@@ -247,8 +261,8 @@ int nlmon_parse_addr_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 	}
 	
 	/* Extract label */
-	if (tb[IFA_LABEL]) {
-		nla_strlcpy(addr_info->label, tb[IFA_LABEL], IFNAMSIZ);
+	if ((nla = nla_index_get(attrs, IFA_LABEL))) {
+		nla_strlcpy(addr_info->label, nla, IFNAMSIZ);
 	} else {
 		/* Use interface name as label */
 		if_indextoname(ifa->ifa_index, addr_info->label);
@@ -262,31 +276,41 @@ int nlmon_parse_addr_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 }
 
 /**
- * Parse route message
+ * Parse address message
  * 
- * Extracts routing information from RTM_NEWROUTE/RTM_DELROUTE messages.
+ * Extracts address information from RTM_NEWADDR/RTM_DELADDR messages.
  */
-int nlmon_parse_route_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
+int nlmon_parse_addr_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 {
-	struct rtmsg *rtm;
-	struct nlattr *tb[RTA_MAX + 1];
-	struct nlmon_route_info *route_info;
+	NLA_INDEX(IFA_MAX) attrs;
 	int ret;
 	
 	if (!nlh || !evt)
 		return -EINVAL;
 	
-	/* Get route message header */
-	rtm = (struct rtmsg *)nlmsg_data(nlh);
-	
-	/* Parse attributes */
-	ret = nlmsg_parse(nlh, sizeof(*rtm), tb, RTA_MAX, NULL);
+	/* Index attributes */
+	ret = nlmsg_parse_index(nlh, sizeof(struct ifaddrmsg), &attrs.hdr, IFA_MAX,
+	                        route_attrs[MSG_CLASS_ADDR].policy, NULL);
 	if (ret < 0) {
-		fprintf(stderr, "Failed to parse route message attributes: %s\n",
+		fprintf(stderr, "Failed to parse address message attributes: %s\n",
 		        nl_geterror(ret));
 		return ret;
 	}
 	
+	return decode_addr_msg(nlh, &attrs.hdr, evt);
+}
+
+/* Decode a route message from its attribute index */
+static int decode_route_msg(struct nlmsghdr *nlh, const struct nla_index *attrs,
+                            struct nlmon_event *evt)
+{
+	struct rtmsg *rtm;
+	struct nlmon_route_info *route_info;
+	struct nlattr *nla;
+	
+	/* Get route message header */
+	rtm = (struct rtmsg *)nlmsg_data(nlh);
+	
 	/* Allocate route info structure */
 	route_info = calloc(1, sizeof(*route_info));
 	if (!route_info)
@@ -311,9 +335,14 @@ int nlmon_parse_route_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 	/* Extract type */
 	route_info->type = rtm->rtm_type;
 	
+	/* Extract table, tables past 255 only come as an attribute */
+	route_info->table = rtm->rtm_table;
+	if ((nla = nla_index_get(attrs, RTA_TABLE)))
+		route_info->table = nla_get_u32(nla);
+	
 	/* Extract destination address */
-	if (tb[RTA_DST]) {
-		void *addr_data = nla_data(tb[RTA_DST]);
+	if ((nla = nla_index_get(attrs, RTA_DST))) {
+		void *addr_data = nla_data(nla);
 		
 		if (rtm->rtm_family == AF_INET) {
 			inet_ntop(AF_INET, addr_data, route_info->dst, sizeof(route_info->dst));
@@ -323,8 +352,8 @@ int nlmon_parse_route_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 	}
 	
 	/* Extract source address */
-	if (tb[RTA_SRC]) {
-		void *addr_data = nla_data(tb[RTA_SRC]);
+	if ((nla = nla_index_get(attrs, RTA_SRC))) {
+		void *addr_data = nla_data(nla);
 		
 		if (rtm->rtm_family == AF_INET) {
 			inet_ntop(AF_INET, addr_data, route_info->src, sizeof(route_info->src));
@@ -334,8 +363,8 @@ int nlmon_parse_route_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 	}
 	
 	/* Extract gateway address */
-	if (tb[RTA_GATEWAY]) {
-		void *addr_data = nla_data(tb[RTA_GATEWAY]);
+	if ((nla = nla_index_get(attrs, RTA_GATEWAY))) {
+		void *addr_data = nla_data(nla);
 		
 		if (rtm->rtm_family == AF_INET) {
 			inet_ntop(AF_INET, addr_data, route_info->gateway, sizeof(route_info->gateway));
@@ -345,14 +374,14 @@ int nlmon_parse_route_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 	}
 	
 	/* Extract output interface */
-	if (tb[RTA_OIF]) {
-		route_info->oif = nla_get_u32(tb[RTA_OIF]);
+	if ((nla = nla_index_get(attrs, RTA_OIF))) {
+		route_info->oif = nla_get_u32(nla);
 		if_indextoname(route_info->oif, evt->interface);
 	}
 	
 	/* Extract priority */
-	if (tb[RTA_PRIORITY]) {
-		route_info->priority = nla_get_u32(tb[RTA_PRIORITY]);
+	if ((nla = nla_index_get(attrs, RTA_PRIORITY))) {
+		route_info->priority = nla_get_u32(nla);
 	}
 	
 	/* Store in event */
@@ -362,31 +391,41 @@ int nlmon_parse_route_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 }
 
 /**
- * Parse neighbor message
+ * Parse route message
  * 
- * Extracts neighbor (ARP/NDP) information from RTM_NEWNEIGH/RTM_DELNEIGH messages.
+ * Extracts routing information from RTM_NEWROUTE/RTM_DELROUTE messages.
  */
-int nlmon_parse_neigh_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
+int nlmon_parse_route_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 {
-	struct ndmsg *ndm;
-	struct nlattr *tb[NDA_MAX + 1];
-	struct nlmon_neigh_info *neigh_info;
+	NLA_INDEX(RTA_MAX) attrs;
 	int ret;
 	
 	if (!nlh || !evt)
 		return -EINVAL;
 	
-	/* Get neighbor message header */
-	ndm = (struct ndmsg *)nlmsg_data(nlh);
-	
-	/* Parse attributes */
-	ret = nlmsg_parse(nlh, sizeof(*ndm), tb, NDA_MAX, NULL);
+	/* Index attributes */
+	ret = nlmsg_parse_index(nlh, sizeof(struct rtmsg), &attrs.hdr, RTA_MAX,
+	                        route_attrs[MSG_CLASS_ROUTE].policy, NULL);
 	if (ret < 0) {
-		fprintf(stderr, "Failed to parse neighbor message attributes: %s\n",
+		fprintf(stderr, "Failed to parse route message attributes: %s\n",
 		        nl_geterror(ret));
 		return ret;
 	}
 	
+	return decode_route_msg(nlh, &attrs.hdr, evt);
+}
+
+/* Decode a neighbor message from its attribute index */
+static int decode_neigh_msg(struct nlmsghdr *nlh, const struct nla_index *attrs,
+                            struct nlmon_event *evt)
+{
+	struct ndmsg *ndm;
+	struct nlmon_neigh_info *neigh_info;
+	struct nlattr *nla;
+	
+	/* Get neighbor message header */
+	ndm = (struct ndmsg *)nlmsg_data(nlh);
+	
 	/* Allocate neighbor info structure */
 	neigh_info = calloc(1, sizeof(*neigh_info));
 	if (!neigh_info)
@@ -405,8 +444,8 @@ int nlmon_parse_neigh_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 	neigh_info->flags = ndm->ndm_flags;
 	
 	/* Extract destination (neighbor) address */
-	if (tb[NDA_DST]) {
-		void *addr_data = nla_data(tb[NDA_DST]);
+	if ((nla = nla_index_get(attrs, NDA_DST))) {
+		void *addr_data = nla_data(nla);
 		
 		if (ndm->ndm_family == AF_INET) {
 			inet_ntop(AF_INET, addr_data, neigh_info->dst, sizeof(neigh_info->dst));
@@ -416,10 +455,10 @@ int nlmon_parse_neigh_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 	}
 	
 	/* Extract link-layer address */
-	if (tb[NDA_LLADDR]) {
-		int addr_len = nla_len(tb[NDA_LLADDR]);
+	if ((nla = nla_index_get(attrs, NDA_LLADDR))) {
+		int addr_len = nla_len(nla);
 		if (addr_len <= ETH_ALEN) {
-			memcpy(neigh_info->lladdr, nla_data(tb[NDA_LLADDR]), addr_len);
+			memcpy(neigh_info->lladdr, nla_data(nla), addr_len);
 		}
 	}
 	
@@ -429,3 +468,132 @@ int nlmon_parse_neigh_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
 	
 	return 0;
 }
+
+/**
+ * Parse neighbor message
+ * 
+ * Extracts neighbor (ARP/NDP) information from RTM_NEWNEIGH/RTM_DELNEIGH messages.
+ */
+int nlmon_parse_neigh_msg(struct nlmsghdr *nlh, struct nlmon_event *evt)
+{
+	NLA_INDEX(NDA_MAX) attrs;
+	int ret;
+	
+	if (!nlh || !evt)
+		return -EINVAL;
+	
+	/* Index attributes */
+	ret = nlmsg_parse_index(nlh, sizeof(struct ndmsg), &attrs.hdr, NDA_MAX,
+	                        route_attrs[MSG_CLASS_NEIGH].policy, NULL);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to parse neighbor message attributes: %s\n",
+		        nl_geterror(ret));
+		return ret;
+	}
+	
+	return decode_neigh_msg(nlh, &attrs.hdr, evt);
+}
+
+/* Every attribute the decoders read must be covered by the index */
+_Static_assert(IFLA_OPERSTATE < NLMON_NL_ATTR_INDEX_SIZE &&
+               IFA_LABEL < NLMON_NL_ATTR_INDEX_SIZE &&
+               RTA_PRIORITY < NLMON_NL_ATTR_INDEX_SIZE &&
+               NDA_LLADDR < NLMON_NL_ATTR_INDEX_SIZE,
+               "lazy decode index too small");
+
+/* Description of an indexable message type, NULL if not indexable */
+static const struct nlmon_nl_msg_desc *route_msg_desc(uint16_t type)
+{
+	const struct nlmon_nl_msg_desc *desc = nlmon_nl_msg_lookup(NETLINK_ROUTE, type);
+	
+	if (!desc || !(desc->subscribers & NLMON_NL_SUB_EVENTS) ||
+	    desc->msg_class >= MSG_CLASS_OTHER)
+		return NULL;
+	
+	return desc;
+}
+
+/**
+ * Build the attribute index of a link, address, route or neighbor message
+ */
+int nlmon_nl_index_route_msg(struct nlmsghdr *nlh, struct nlmon_nl_attr_index *index)
+{
+	const struct nlmon_nl_msg_desc *desc;
+	int maxtype;
+	
+	if (!nlh || !index)
+		return -EINVAL;
+	
+	desc = route_msg_desc(nlh->nlmsg_type);
+	if (!desc)
+		return -EINVAL;
+	
+	/* Types past the index are never read by the decoders */
+	maxtype = route_attrs[desc->msg_class].maxtype;
+	if (maxtype > NLMON_NL_ATTR_INDEX_SIZE - 1)
+		maxtype = NLMON_NL_ATTR_INDEX_SIZE - 1;
+	
+	index->hdrlen = desc->hdrlen;
+	return nlmsg_parse_index(nlh, desc->hdrlen, &index->attrs.hdr, maxtype,
+	                         route_attrs[desc->msg_class].policy, NULL);
+}
+
+/**
+ * Look up an attribute through the index
+ */
+struct nlattr *nlmon_nl_index_attr(struct nlmsghdr *nlh,
+                                   const struct nlmon_nl_attr_index *index, int type)
+{
+	if (!nlh || !index)
+		return NULL;
+	
+	return nla_index_get(&index->attrs.hdr, type);
+}
+
+/* Decoders from an attribute index, by message class */
+static int (*const route_decoders[MSG_CLASS_OTHER])(struct nlmsghdr *,
+                                                    const struct nla_index *,
+                                                    struct nlmon_event *) = {
+	[MSG_CLASS_LINK] = decode_link_msg,
+	[MSG_CLASS_ADDR] = decode_addr_msg,
+	[MSG_CLASS_ROUTE] = decode_route_msg,
+	[MSG_CLASS_NEIGH] = decode_neigh_msg,
+};
+
+/* nlmon_event_lazy callback of deferred NETLINK_ROUTE events */
+static int route_lazy_materialize(struct nlmon_event *evt)
+{
+	struct nlmon_nl_route_lazy *lazy = (struct nlmon_nl_route_lazy *)evt->netlink.lazy;
+	const struct nlmon_nl_msg_desc *desc;
+	
+	/* Decode at most once, even if it fails */
+	evt->netlink.lazy = NULL;
+	
+	desc = nlmon_nl_msg_lookup(NETLINK_ROUTE, lazy->nlh->nlmsg_type);
+	if (!desc || desc->msg_class >= MSG_CLASS_OTHER || !route_decoders[desc->msg_class])
+		return -EINVAL;
+	
+	return route_decoders[desc->msg_class](lazy->nlh, &lazy->index.attrs.hdr, evt);
+}
+
+/**
+ * Defer decoding of a link, address, route or neighbor message
+ */
+int nlmon_defer_route_msg(struct nlmsghdr *nlh, struct nlmon_event *evt,
+                          struct nlmon_nl_route_lazy *lazy)
+{
+	int ret;
+	
+	if (!nlh || !evt || !lazy)
+		return -EINVAL;
+	
+	ret = nlmon_nl_index_route_msg(nlh, &lazy->index);
+	if (ret < 0)
+		return ret;
+	
+	lazy->base.materialize = route_lazy_materialize;
+	lazy->nlh = nlh;
+	evt->netlink.lazy = &lazy->base;
+	
+	return 0;
+}
@@ -1,151 +1,556 @@
 /* object_pool.c - Generic object pool implementation
  *
  * Thread-safe object pool with statistics tracking.
+ *
+ * The slab is split into chains of at most one magazine of objects,
+ * linked by index. The depot is a Treiber stack of such chains whose
+ * head carries a tag against ABA, so a whole magazine moves between a
+ * thread cache and the depot with a single compare-and-swap.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <stdatomic.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 #include "object_pool.h"
+#include "huge_alloc.h"
+
+/* Default and largest objects per magazine */
+#define OP_MAGAZINE_SIZE 32
+#define OP_MAGAZINE_MAX 1024
+
+/* Pools a thread keeps a cache for, further pools use the depot directly */
+#define OP_TLS_SLOTS 8
+
+/* End of a chain or of the depot */
+#define OP_NIL UINT32_MAX
+
+/* Statistics counters, see struct object_pool_stats */
+enum op_counter {
+	OP_ALLOCS,
+	OP_FREES,
+	OP_HITS,
+	OP_MISSES,
+	OP_CACHE_HITS,
+	OP_REFILLS,
+	OP_FLUSHES,
+	OP_COUNTERS
+};
+
+/* Per-thread cache, counters are only written by the owning thread */
+struct op_cache {
+	struct op_cache *next;    /* Pool cache list, under caches_lock */
+	pid_t tid;
+	void **loaded;            /* Magazine allocations come from */
+	size_t loaded_count;
+	void **previous;          /* Spare magazine, full or empty */
+	size_t previous_count;
+	atomic_ulong counts[OP_COUNTERS];
+};
 
 /* Object pool structure */
 struct object_pool {
-	void **objects;           /* Array of object pointers */
 	size_t object_size;       /* Size of each object */
 	size_t capacity;          /* Maximum pool size */
+	size_t stride;            /* Distance of objects in the slab */
+	size_t magazine_size;
+	unsigned long id;         /* Tells a pool from an earlier one at its address */
+	
+	/* Slab and depot */
+	char *slab;
+	bool hugepages;
+	uint32_t *link;           /* Next object within a chain */
+	_Atomic uint32_t *chain_next; /* Next chain in the depot, for chain heads */
+	atomic_ullong depot;      /* Tag in the upper, head chain in the lower half */
 	
-	/* Free list management */
-	atomic_size_t free_count; /* Number of free objects */
-	pthread_mutex_t mutex;    /* Protects free list operations */
+	/* Thread caches */
+	pthread_mutex_t caches_lock;  /* Protects caches and base */
+	struct op_cache *caches;
 	
-	/* Statistics */
-	atomic_size_t allocated;
+	/* Statistics of exited and uncached threads */
+	atomic_ulong counts[OP_COUNTERS];
+	unsigned long base[OP_COUNTERS];  /* Totals at the last reset */
+	atomic_size_t slab_out;   /* Objects outside the depot, cached or in use */
+	atomic_size_t heap_out;   /* Heap allocations not yet freed */
 	atomic_size_t peak_usage;
-	atomic_ulong total_allocs;
-	atomic_ulong total_frees;
-	atomic_ulong pool_hits;
-	atomic_ulong pool_misses;
+	
+	struct object_pool *next; /* Live pool registry */
 };
 
+/* Thread cache slot */
+struct op_tls_slot {
+	struct object_pool *pool;
+	unsigned long id;
+	struct op_cache *cache;
+};
+
+static __thread struct op_tls_slot op_tls[OP_TLS_SLOTS];
+
+/* Live pools, lets exiting threads tell whether their caches are still valid */
+static pthread_mutex_t op_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct object_pool *op_registry;
+static unsigned long op_next_id = 1;
+
+/* Bumped when a pool is destroyed, slots can only go stale then */
+static atomic_ulong op_registry_gen;
+static __thread unsigned long op_tls_full_gen = (unsigned long)-1;
+
+static pthread_key_t op_tls_key;
+static pthread_once_t op_tls_once = PTHREAD_ONCE_INIT;
+
+/* Bump a counter only the calling thread writes */
+static inline void op_count(atomic_ulong *counts, enum op_counter c, unsigned long n)
+{
+	atomic_store_explicit(&counts[c],
+	                      atomic_load_explicit(&counts[c], memory_order_relaxed) + n,
+	                      memory_order_relaxed);
+}
+
+static inline uint32_t op_index(struct object_pool *pool, void *obj)
+{
+	return (uint32_t)(((char *)obj - pool->slab) / pool->stride);
+}
+
+static inline void *op_object(struct object_pool *pool, uint32_t index)
+{
+	return pool->slab + (size_t)index * pool->stride;
+}
+
+static inline bool op_in_slab(struct object_pool *pool, void *obj)
+{
+	return (char *)obj >= pool->slab &&
+	       (char *)obj < pool->slab + pool->capacity * pool->stride;
+}
+
+static void op_note_usage(struct object_pool *pool)
+{
+	size_t usage, peak;
+	
+	usage = atomic_load_explicit(&pool->slab_out, memory_order_relaxed) +
+	        atomic_load_explicit(&pool->heap_out, memory_order_relaxed);
+	peak = atomic_load_explicit(&pool->peak_usage, memory_order_relaxed);
+	while (usage > peak) {
+		if (atomic_compare_exchange_weak_explicit(&pool->peak_usage, &peak, usage,
+		                                          memory_order_relaxed,
+		                                          memory_order_relaxed))
+			break;
+	}
+}
+
+/* Push a chain linked through pool->link */
+static void op_depot_push(struct object_pool *pool, uint32_t head)
+{
+	uint64_t old, new;
+	
+	old = atomic_load_explicit(&pool->depot, memory_order_relaxed);
+	do {
+		atomic_store_explicit(&pool->chain_next[head], (uint32_t)old,
+		                      memory_order_relaxed);
+		new = (((old >> 32) + 1) << 32) | head;
+	} while (!atomic_compare_exchange_weak_explicit(&pool->depot, &old, new,
+	                                                memory_order_release,
+	                                                memory_order_relaxed));
+}
+
+/* Pop a chain, OP_NIL if the depot is empty */
+static uint32_t op_depot_pop(struct object_pool *pool)
+{
+	uint64_t old, new;
+	uint32_t head;
+	
+	old = atomic_load_explicit(&pool->depot, memory_order_acquire);
+	do {
+		head = (uint32_t)old;
+		if (head == OP_NIL)
+			return OP_NIL;
+		
+		new = (((old >> 32) + 1) << 32) |
+		      atomic_load_explicit(&pool->chain_next[head], memory_order_relaxed);
+	} while (!atomic_compare_exchange_weak_explicit(&pool->depot, &old, new,
+	                                                memory_order_acquire,
+	                                                memory_order_acquire));
+	
+	return head;
+}
+
+/* Return a magazine to the depot as one chain */
+static void op_flush(struct object_pool *pool, void **objects, size_t count)
+{
+	uint32_t head = OP_NIL, index;
+	size_t i;
+	
+	if (!count)
+		return;
+	
+	for (i = 0; i < count; i++) {
+		index = op_index(pool, objects[i]);
+		pool->link[index] = head;
+		head = index;
+	}
+	
+	op_depot_push(pool, head);
+	atomic_fetch_sub_explicit(&pool->slab_out, count, memory_order_relaxed);
+}
+
+/* Fill a magazine from one depot chain, returns the objects taken */
+static size_t op_refill(struct object_pool *pool, void **objects)
+{
+	uint32_t index;
+	size_t count = 0;
+	
+	for (index = op_depot_pop(pool); index != OP_NIL; index = pool->link[index])
+		objects[count++] = op_object(pool, index);
+	
+	if (count) {
+		atomic_fetch_add_explicit(&pool->slab_out, count, memory_order_relaxed);
+		op_note_usage(pool);
+	}
+	
+	return count;
+}
+
+/* Fold an exiting thread's cache into the pool, caller holds op_registry_lock */
+static void op_cache_retire(struct object_pool *pool, struct op_cache *cache)
+{
+	struct op_cache **pp;
+	int c;
+	
+	op_flush(pool, cache->loaded, cache->loaded_count);
+	op_flush(pool, cache->previous, cache->previous_count);
+	
+	pthread_mutex_lock(&pool->caches_lock);
+	for (pp = &pool->caches; *pp; pp = &(*pp)->next) {
+		if (*pp == cache) {
+			*pp = cache->next;
+			break;
+		}
+	}
+	for (c = 0; c < OP_COUNTERS; c++)
+		atomic_fetch_add_explicit(&pool->counts[c],
+		                          atomic_load_explicit(&cache->counts[c],
+		                                               memory_order_relaxed),
+		                          memory_order_relaxed);
+	pthread_mutex_unlock(&pool->caches_lock);
+	
+	free(cache);
+}
+
+static void op_tls_destructor(void *arg)
+{
+	struct op_tls_slot *slots = arg;
+	struct object_pool *pool;
+	int i;
+	
+	pthread_mutex_lock(&op_registry_lock);
+	for (i = 0; i < OP_TLS_SLOTS; i++) {
+		if (!slots[i].pool)
+			continue;
+		
+		/* Caches of destroyed pools went with them */
+		for (pool = op_registry; pool; pool = pool->next) {
+			if (pool == slots[i].pool && pool->id == slots[i].id) {
+				op_cache_retire(pool, slots[i].cache);
+				break;
+			}
+		}
+		slots[i].pool = NULL;
+	}
+	pthread_mutex_unlock(&op_registry_lock);
+}
+
+static void op_tls_init(void)
+{
+	pthread_key_create(&op_tls_key, op_tls_destructor);
+}
+
+/* True if a slot's pool is still registered under the slot's ID */
+static bool op_slot_live(struct op_tls_slot *slot)
+{
+	struct object_pool *pool;
+	bool live = false;
+	
+	pthread_mutex_lock(&op_registry_lock);
+	for (pool = op_registry; pool; pool = pool->next) {
+		if (pool == slot->pool && pool->id == slot->id) {
+			live = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&op_registry_lock);
+	
+	return live;
+}
+
+/* Calling thread's cache for a pool, NULL if it has no free slot */
+static struct op_cache *op_cache_get(struct object_pool *pool)
+{
+	struct op_tls_slot *slot = NULL;
+	struct op_cache *cache;
+	int i;
+	
+	for (i = 0; i < OP_TLS_SLOTS; i++) {
+		if (op_tls[i].pool == pool) {
+			if (op_tls[i].id == pool->id)
+				return op_tls[i].cache;
+			
+			/* An earlier pool at the same address */
+			slot = &op_tls[i];
+			break;
+		}
+	}
+	
+	for (i = 0; !slot && i < OP_TLS_SLOTS; i++) {
+		if (!op_tls[i].pool)
+			slot = &op_tls[i];
+	}
+	
+	/* All slots taken, look for stale ones unless none can have appeared */
+	if (!slot) {
+		unsigned long gen = atomic_load_explicit(&op_registry_gen, memory_order_relaxed);
+		
+		if (gen == op_tls_full_gen)
+			return NULL;
+		for (i = 0; !slot && i < OP_TLS_SLOTS; i++) {
+			if (!op_slot_live(&op_tls[i]))
+				slot = &op_tls[i];
+		}
+		if (!slot) {
+			op_tls_full_gen = gen;
+			return NULL;
+		}
+	}
+	
+	cache = calloc(1, sizeof(*cache) + 2 * pool->magazine_size * sizeof(void *));
+	if (!cache)
+		return NULL;
+	
+	cache->tid = (pid_t)syscall(SYS_gettid);
+	cache->loaded = (void **)(cache + 1);
+	cache->previous = cache->loaded + pool->magazine_size;
+	
+	pthread_once(&op_tls_once, op_tls_init);
+	pthread_setspecific(op_tls_key, op_tls);
+	
+	pthread_mutex_lock(&pool->caches_lock);
+	cache->next = pool->caches;
+	pool->caches = cache;
+	pthread_mutex_unlock(&pool->caches_lock);
+	
+	slot->pool = pool;
+	slot->id = pool->id;
+	slot->cache = cache;
+	return cache;
+}
+
+/* Allocate the slab, from huge pages if asked and available */
+static int op_slab_alloc(struct object_pool *pool, bool hugepages)
+{
+	pool->slab = huge_calloc(pool->capacity, pool->stride,
+	                         hugepages ? HUGE_ALLOC_FORCE : 0, "object_pool");
+	if (!pool->slab)
+		return -1;
+	pool->hugepages = huge_alloc_backed(pool->slab);
+	return 0;
+}
+
 struct object_pool *object_pool_create(size_t object_size, size_t capacity)
+{
+	struct object_pool_options opts = {
+		.object_size = object_size,
+		.capacity = capacity,
+	};
+	
+	return object_pool_create_opts(&opts);
+}
+
+struct object_pool *object_pool_create_opts(const struct object_pool_options *opts)
 {
 	struct object_pool *pool;
-	size_t i;
+	size_t align = _Alignof(max_align_t);
+	size_t i, start;
 	
-	if (object_size == 0 || capacity == 0)
+	if (!opts || opts->object_size == 0 || opts->capacity == 0 ||
+	    opts->capacity >= OP_NIL)
 		return NULL;
 	
 	pool = calloc(1, sizeof(*pool));
 	if (!pool)
 		return NULL;
 	
-	pool->object_size = object_size;
-	pool->capacity = capacity;
+	pool->object_size = opts->object_size;
+	pool->capacity = opts->capacity;
+	pool->stride = (opts->object_size + align - 1) & ~(align - 1);
+	pool->magazine_size = opts->magazine_size ? opts->magazine_size : OP_MAGAZINE_SIZE;
+	if (pool->magazine_size > OP_MAGAZINE_MAX)
+		pool->magazine_size = OP_MAGAZINE_MAX;
 	
-	/* Allocate object pointer array */
-	pool->objects = calloc(capacity, sizeof(void *));
-	if (!pool->objects) {
+	/* Allocate the slab and its links */
+	if (op_slab_alloc(pool, opts->hugepages) < 0) {
 		free(pool);
 		return NULL;
 	}
 	
-	/* Pre-allocate all objects */
-	for (i = 0; i < capacity; i++) {
-		pool->objects[i] = calloc(1, object_size);
-		if (!pool->objects[i]) {
-			/* Cleanup on failure */
-			for (size_t j = 0; j < i; j++)
-				free(pool->objects[j]);
-			free(pool->objects);
-			free(pool);
-			return NULL;
-		}
+	pool->link = calloc(pool->capacity, sizeof(*pool->link));
+	pool->chain_next = calloc(pool->capacity, sizeof(*pool->chain_next));
+	if (!pool->link || !pool->chain_next) {
+		free(pool->chain_next);
+		free(pool->link);
+		huge_free(pool->slab);
+		free(pool);
+		return NULL;
 	}
 	
-	/* Initialize atomics */
-	atomic_init(&pool->free_count, capacity);
-	atomic_init(&pool->allocated, 0);
-	atomic_init(&pool->peak_usage, 0);
-	atomic_init(&pool->total_allocs, 0);
-	atomic_init(&pool->total_frees, 0);
-	atomic_init(&pool->pool_hits, 0);
-	atomic_init(&pool->pool_misses, 0);
-	
 	/* Initialize mutex */
-	if (pthread_mutex_init(&pool->mutex, NULL) != 0) {
-		for (i = 0; i < capacity; i++)
-			free(pool->objects[i]);
-		free(pool->objects);
+	if (pthread_mutex_init(&pool->caches_lock, NULL) != 0) {
+		free(pool->chain_next);
+		free(pool->link);
+		huge_free(pool->slab);
 		free(pool);
 		return NULL;
 	}
 	
+	/* Stock the depot with magazine sized chains */
+	atomic_init(&pool->depot, OP_NIL);
+	for (start = 0; start < pool->capacity; start += pool->magazine_size) {
+		size_t end = start + pool->magazine_size;
+		
+		if (end > pool->capacity)
+			end = pool->capacity;
+		for (i = start; i < end; i++)
+			pool->link[i] = i + 1 < end ? (uint32_t)(i + 1) : OP_NIL;
+		op_depot_push(pool, (uint32_t)start);
+	}
+	
+	/* Initialize atomics */
+	for (i = 0; i < OP_COUNTERS; i++)
+		atomic_init(&pool->counts[i], 0);
+	atomic_init(&pool->slab_out, 0);
+	atomic_init(&pool->heap_out, 0);
+	atomic_init(&pool->peak_usage, 0);
+	
+	pthread_mutex_lock(&op_registry_lock);
+	pool->id = op_next_id++;
+	pool->next = op_registry;
+	op_registry = pool;
+	pthread_mutex_unlock(&op_registry_lock);
+	
 	return pool;
 }
 
 void object_pool_destroy(struct object_pool *pool)
 {
-	size_t i;
+	struct object_pool **pp;
+	struct op_cache *cache, *next;
 	
 	if (!pool)
 		return;
 	
-	/* Free all objects */
-	for (i = 0; i < pool->capacity; i++) {
-		if (pool->objects[i])
-			free(pool->objects[i]);
+	/* Exiting threads must not retire caches into a dying pool */
+	pthread_mutex_lock(&op_registry_lock);
+	for (pp = &op_registry; *pp; pp = &(*pp)->next) {
+		if (*pp == pool) {
+			*pp = pool->next;
+			break;
+		}
+	}
+	atomic_fetch_add_explicit(&op_registry_gen, 1, memory_order_relaxed);
+	pthread_mutex_unlock(&op_registry_lock);
+	
+	/* Free all caches, their slots go stale with the pool ID */
+	for (cache = pool->caches; cache; cache = next) {
+		next = cache->next;
+		free(cache);
 	}
 	
-	free(pool->objects);
-	pthread_mutex_destroy(&pool->mutex);
+	free(pool->chain_next);
+	free(pool->link);
+	huge_free(pool->slab);
+	pthread_mutex_destroy(&pool->caches_lock);
 	free(pool);
 }
 
+/* Allocate without a thread cache */
+static void *op_alloc_direct(struct object_pool *pool)
+{
+	uint32_t index;
+	
+	index = op_depot_pop(pool);
+	if (index == OP_NIL)
+		return NULL;
+	
+	/* Keep one object, hand the rest of the chain back */
+	if (pool->link[index] != OP_NIL)
+		op_depot_push(pool, pool->link[index]);
+	
+	atomic_fetch_add_explicit(&pool->slab_out, 1, memory_order_relaxed);
+	op_note_usage(pool);
+	return op_object(pool, index);
+}
+
 void *object_pool_alloc(struct object_pool *pool)
 {
+	struct op_cache *cache;
 	void *obj = NULL;
-	size_t free_count, allocated, peak;
+	void **swap;
+	bool cached = false;
 	
 	if (!pool)
 		return NULL;
 	
-	pthread_mutex_lock(&pool->mutex);
-	
-	/* Try to get object from pool */
-	free_count = atomic_load_explicit(&pool->free_count, memory_order_acquire);
-	if (free_count > 0) {
-		/* Get object from free list */
-		free_count--;
-		obj = pool->objects[free_count];
-		pool->objects[free_count] = NULL;
-		atomic_store_explicit(&pool->free_count, free_count, memory_order_release);
+	cache = op_cache_get(pool);
+	if (cache) {
+		if (!cache->loaded_count && cache->previous_count) {
+			/* Spare magazine has objects, no depot access needed */
+			swap = cache->loaded;
+			cache->loaded = cache->previous;
+			cache->previous = swap;
+			cache->loaded_count = cache->previous_count;
+			cache->previous_count = 0;
+		}
+		
+		if (cache->loaded_count) {
+			cached = true;
+		} else {
+			cache->loaded_count = op_refill(pool, cache->loaded);
+			if (cache->loaded_count)
+				op_count(cache->counts, OP_REFILLS, 1);
+		}
 		
-		/* Update statistics */
-		atomic_fetch_add_explicit(&pool->pool_hits, 1, memory_order_relaxed);
+		if (cache->loaded_count)
+			obj = cache->loaded[--cache->loaded_count];
 	} else {
-		/* Pool empty, allocate from heap */
-		obj = calloc(1, pool->object_size);
-		atomic_fetch_add_explicit(&pool->pool_misses, 1, memory_order_relaxed);
+		obj = op_alloc_direct(pool);
 	}
 	
-	pthread_mutex_unlock(&pool->mutex);
-	
 	if (obj) {
-		/* Update allocation statistics */
-		allocated = atomic_fetch_add_explicit(&pool->allocated, 1, memory_order_relaxed) + 1;
-		atomic_fetch_add_explicit(&pool->total_allocs, 1, memory_order_relaxed);
-		
-		/* Update peak usage */
-		peak = atomic_load_explicit(&pool->peak_usage, memory_order_relaxed);
-		while (allocated > peak) {
-			if (atomic_compare_exchange_weak_explicit(&pool->peak_usage, &peak, allocated,
-			                                          memory_order_relaxed,
-			                                          memory_order_relaxed))
-				break;
-		}
-		
 		/* Zero the object */
 		memset(obj, 0, pool->object_size);
+	} else {
+		/* Pool empty, allocate from heap */
+		obj = calloc(1, pool->object_size);
+		if (!obj)
+			return NULL;
+		
+		atomic_fetch_add_explicit(&pool->heap_out, 1, memory_order_relaxed);
+		op_note_usage(pool);
+	}
+	
+	/* Update statistics */
+	if (cache) {
+		op_count(cache->counts, OP_ALLOCS, 1);
+		op_count(cache->counts, op_in_slab(pool, obj) ? OP_HITS : OP_MISSES, 1);
+		if (cached)
+			op_count(cache->counts, OP_CACHE_HITS, 1);
+	} else {
+		atomic_fetch_add_explicit(&pool->counts[OP_ALLOCS], 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&pool->counts[op_in_slab(pool, obj) ? OP_HITS : OP_MISSES],
+		                          1, memory_order_relaxed);
 	}
 	
 	return obj;
@@ -153,67 +558,158 @@ void *object_pool_alloc(struct object_pool *pool)
 
 void object_pool_free(struct object_pool *pool, void *obj)
 {
-	size_t free_count;
+	struct op_cache *cache;
+	void **swap;
+	uint32_t index;
 	
 	if (!pool || !obj)
 		return;
 	
+	cache = op_cache_get(pool);
+	if (cache)
+		op_count(cache->counts, OP_FREES, 1);
+	else
+		atomic_fetch_add_explicit(&pool->counts[OP_FREES], 1, memory_order_relaxed);
+	
+	/* Objects from the heap go back to it */
+	if (!op_in_slab(pool, obj)) {
+		free(obj);
+		atomic_fetch_sub_explicit(&pool->heap_out, 1, memory_order_relaxed);
+		return;
+	}
+	
 	/* Zero the object */
 	memset(obj, 0, pool->object_size);
 	
-	pthread_mutex_lock(&pool->mutex);
+	if (!cache) {
+		index = op_index(pool, obj);
+		pool->link[index] = OP_NIL;
+		op_depot_push(pool, index);
+		atomic_fetch_sub_explicit(&pool->slab_out, 1, memory_order_relaxed);
+		return;
+	}
 	
-	/* Try to return object to pool */
-	free_count = atomic_load_explicit(&pool->free_count, memory_order_acquire);
-	if (free_count < pool->capacity) {
-		/* Return to pool */
-		pool->objects[free_count] = obj;
-		free_count++;
-		atomic_store_explicit(&pool->free_count, free_count, memory_order_release);
-	} else {
-		/* Pool full, free to heap */
-		free(obj);
+	if (cache->loaded_count == pool->magazine_size) {
+		/* Both magazines full, the spare one goes to the depot */
+		if (cache->previous_count == pool->magazine_size) {
+			op_flush(pool, cache->previous, cache->previous_count);
+			cache->previous_count = 0;
+			op_count(cache->counts, OP_FLUSHES, 1);
+		}
+		
+		swap = cache->loaded;
+		cache->loaded = cache->previous;
+		cache->previous = swap;
+		cache->previous_count = cache->loaded_count;
+		cache->loaded_count = 0;
 	}
 	
-	pthread_mutex_unlock(&pool->mutex);
+	cache->loaded[cache->loaded_count++] = obj;
+}
+
+/* Counter totals, caller holds caches_lock */
+static void op_sum(struct object_pool *pool, unsigned long *sum)
+{
+	struct op_cache *cache;
+	int c;
 	
-	/* Update statistics */
-	atomic_fetch_sub_explicit(&pool->allocated, 1, memory_order_relaxed);
-	atomic_fetch_add_explicit(&pool->total_frees, 1, memory_order_relaxed);
+	for (c = 0; c < OP_COUNTERS; c++)
+		sum[c] = atomic_load_explicit(&pool->counts[c], memory_order_relaxed);
+	
+	for (cache = pool->caches; cache; cache = cache->next) {
+		for (c = 0; c < OP_COUNTERS; c++)
+			sum[c] += atomic_load_explicit(&cache->counts[c], memory_order_relaxed);
+	}
+}
+
+/* Objects handed out, frees may be counted ahead of their allocation */
+static size_t op_allocated(const unsigned long *sum)
+{
+	return sum[OP_ALLOCS] > sum[OP_FREES] ? sum[OP_ALLOCS] - sum[OP_FREES] : 0;
 }
 
 void object_pool_get_stats(struct object_pool *pool, struct object_pool_stats *stats)
 {
+	unsigned long sum[OP_COUNTERS];
+	
 	if (!pool || !stats)
 		return;
 	
+	pthread_mutex_lock(&pool->caches_lock);
+	op_sum(pool, sum);
+	
 	stats->capacity = pool->capacity;
-	stats->allocated = atomic_load_explicit(&pool->allocated, memory_order_relaxed);
+	stats->allocated = op_allocated(sum);
 	stats->peak_usage = atomic_load_explicit(&pool->peak_usage, memory_order_relaxed);
-	stats->total_allocs = atomic_load_explicit(&pool->total_allocs, memory_order_relaxed);
-	stats->total_frees = atomic_load_explicit(&pool->total_frees, memory_order_relaxed);
-	stats->pool_hits = atomic_load_explicit(&pool->pool_hits, memory_order_relaxed);
-	stats->pool_misses = atomic_load_explicit(&pool->pool_misses, memory_order_relaxed);
+	stats->total_allocs = sum[OP_ALLOCS] - pool->base[OP_ALLOCS];
+	stats->total_frees = sum[OP_FREES] - pool->base[OP_FREES];
+	stats->pool_hits = sum[OP_HITS] - pool->base[OP_HITS];
+	stats->pool_misses = sum[OP_MISSES] - pool->base[OP_MISSES];
+	stats->cache_hits = sum[OP_CACHE_HITS] - pool->base[OP_CACHE_HITS];
+	stats->depot_refills = sum[OP_REFILLS] - pool->base[OP_REFILLS];
+	stats->depot_flushes = sum[OP_FLUSHES] - pool->base[OP_FLUSHES];
+	stats->hugepages = pool->hugepages;
+	pthread_mutex_unlock(&pool->caches_lock);
+}
+
+size_t object_pool_get_thread_stats(struct object_pool *pool,
+                                    struct object_pool_thread_stats *stats,
+                                    size_t max)
+{
+	struct op_cache *cache;
+	size_t count = 0;
+	
+	if (!pool)
+		return 0;
+	
+	pthread_mutex_lock(&pool->caches_lock);
+	for (cache = pool->caches; cache; cache = cache->next, count++) {
+		if (!stats || count >= max)
+			continue;
+		
+		stats[count].tid = cache->tid;
+		stats[count].allocs = atomic_load_explicit(&cache->counts[OP_ALLOCS],
+		                                           memory_order_relaxed);
+		stats[count].frees = atomic_load_explicit(&cache->counts[OP_FREES],
+		                                          memory_order_relaxed);
+		stats[count].cache_hits = atomic_load_explicit(&cache->counts[OP_CACHE_HITS],
+		                                               memory_order_relaxed);
+		stats[count].depot_refills = atomic_load_explicit(&cache->counts[OP_REFILLS],
+		                                                  memory_order_relaxed);
+		stats[count].depot_flushes = atomic_load_explicit(&cache->counts[OP_FLUSHES],
+		                                                  memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&pool->caches_lock);
+	
+	return count;
 }
 
 void object_pool_reset_stats(struct object_pool *pool)
 {
+	unsigned long sum[OP_COUNTERS];
+	
 	if (!pool)
 		return;
 	
 	/* Reset counters but preserve current allocated count and peak */
-	atomic_store_explicit(&pool->total_allocs, 0, memory_order_relaxed);
-	atomic_store_explicit(&pool->total_frees, 0, memory_order_relaxed);
-	atomic_store_explicit(&pool->pool_hits, 0, memory_order_relaxed);
-	atomic_store_explicit(&pool->pool_misses, 0, memory_order_relaxed);
+	pthread_mutex_lock(&pool->caches_lock);
+	op_sum(pool, sum);
+	memcpy(pool->base, sum, sizeof(pool->base));
+	pthread_mutex_unlock(&pool->caches_lock);
 }
 
 size_t object_pool_get_usage(struct object_pool *pool)
 {
+	unsigned long sum[OP_COUNTERS];
+	
 	if (!pool)
 		return 0;
 	
-	return atomic_load_explicit(&pool->allocated, memory_order_relaxed);
+	pthread_mutex_lock(&pool->caches_lock);
+	op_sum(pool, sum);
+	pthread_mutex_unlock(&pool->caches_lock);
+	
+	return op_allocated(sum);
 }
 
 size_t object_pool_get_capacity(struct object_pool *pool)
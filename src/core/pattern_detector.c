@@ -2,6 +2,13 @@
  *
  * Detects repeating patterns in network events, analyzes frequency,
  * and generates alerts for significant patterns.
+ *
+ * Event sequences run as an automaton over partial matches. Slot base + i
+ * of a sequence holds the start time of the most recent partial match
+ * waiting for step i, and the symbol table maps an event type and message
+ * type to the steps it completes. An event moves every partial match it
+ * completes a step of on by one slot, the highest slots first so one
+ * event never completes two steps of the same match.
  */
 
 #include "correlation_engine.h"
@@ -13,6 +20,14 @@
 
 #define MAX_PATTERN_TYPES 256
 
+/* Open addressed table of sequence symbols, twice the most symbols */
+#define SEQUENCE_SYMBOL_BUCKETS (2 * PATTERN_MAX_SEQUENCES * PATTERN_SEQUENCE_MAX_STEPS)
+#define SEQUENCE_KEY_BUCKETS 64
+#define SEQUENCE_MAX_REFS (PATTERN_MAX_SEQUENCES * PATTERN_SEQUENCE_MAX_STEPS)
+
+/* Start time of a slot without a partial match */
+#define SEQUENCE_NONE ((time_t)-1)
+
 /* Pattern statistics */
 struct pattern_stats {
 	uint32_t event_type;
@@ -24,6 +39,36 @@ struct pattern_stats {
 	bool alert_triggered;
 };
 
+/* Step of a sequence an event of some symbol completes */
+struct sequence_ref {
+	uint16_t slot;                  /* Partial match waiting for the step */
+	uint8_t sequence;
+	uint8_t step;
+};
+
+/* Steps sharing one event type and message type */
+struct sequence_symbol {
+	uint32_t event_type;
+	uint16_t message_type;
+	struct sequence_ref *refs;
+	size_t ref_count;
+};
+
+struct sequence {
+	struct pattern_sequence_def def;
+	size_t base;                    /* Slot of step 0 */
+	size_t matches;
+};
+
+/* Partial matches of one interface */
+struct sequence_key {
+	char interface[16];
+	time_t *starts;                 /* Per slot */
+	struct sequence_key *hash_next;
+	struct sequence_key *lru_prev;
+	struct sequence_key *lru_next;
+};
+
 /* Pattern detector structure */
 struct pattern_detector {
 	struct time_window *window;
@@ -32,6 +77,19 @@ struct pattern_detector {
 	size_t min_frequency;
 	time_t window_sec;
 	pthread_mutex_t lock;
+
+	/* Event sequences */
+	struct sequence sequences[PATTERN_MAX_SEQUENCES];
+	size_t sequence_count;
+	size_t slot_count;
+	struct sequence_symbol symbols[SEQUENCE_MAX_REFS];
+	size_t symbol_count;
+	uint16_t symbol_table[SEQUENCE_SYMBOL_BUCKETS]; /* Symbol + 1, 0 if empty */
+	time_t *global_starts;          /* Sequences not on the same interface */
+	struct sequence_key *keys[SEQUENCE_KEY_BUCKETS];
+	struct sequence_key *lru_head;  /* Most recently seen */
+	struct sequence_key *lru_tail;
+	size_t key_count;
 };
 
 struct pattern_detector *pattern_detector_create(time_t window_sec,
@@ -65,11 +123,34 @@ struct pattern_detector *pattern_detector_create(time_t window_sec,
 	return detector;
 }
 
+static void sequence_keys_free(struct pattern_detector *detector)
+{
+	struct sequence_key *key, *next;
+
+	for (key = detector->lru_head; key; key = next) {
+		next = key->lru_next;
+		free(key->starts);
+		free(key);
+	}
+
+	memset(detector->keys, 0, sizeof(detector->keys));
+	detector->lru_head = NULL;
+	detector->lru_tail = NULL;
+	detector->key_count = 0;
+}
+
 void pattern_detector_destroy(struct pattern_detector *detector)
 {
+	size_t i;
+
 	if (!detector)
 		return;
 
+	sequence_keys_free(detector);
+	free(detector->global_starts);
+	for (i = 0; i < detector->symbol_count; i++)
+		free(detector->symbols[i].refs);
+
 	time_window_destroy(detector->window);
 	pthread_mutex_destroy(&detector->lock);
 	free(detector);
@@ -142,6 +223,298 @@ static bool should_alert(struct pattern_stats *pattern, size_t min_frequency)
 	return false;
 }
 
+static uint32_t symbol_hash(uint32_t event_type, uint16_t message_type)
+{
+	uint32_t hash = event_type * 0x9e3779b1u ^ message_type * 0x85ebca6bu;
+
+	return (hash ^ (hash >> 15)) % SEQUENCE_SYMBOL_BUCKETS;
+}
+
+/* Symbol of the exact event type and message type, NULL if none */
+static struct sequence_symbol *symbol_find(struct pattern_detector *detector,
+                                           uint32_t event_type, uint16_t message_type,
+                                           size_t *bucket)
+{
+	size_t i = symbol_hash(event_type, message_type);
+
+	for (; detector->symbol_table[i]; i = (i + 1) % SEQUENCE_SYMBOL_BUCKETS) {
+		struct sequence_symbol *symbol = &detector->symbols[detector->symbol_table[i] - 1];
+
+		if (symbol->event_type == event_type && symbol->message_type == message_type)
+			return symbol;
+	}
+
+	if (bucket)
+		*bucket = i;
+	return NULL;
+}
+
+static bool symbol_add_ref(struct pattern_detector *detector, const struct pattern_step *step,
+                           struct sequence_ref ref)
+{
+	struct sequence_symbol *symbol;
+	struct sequence_ref *refs;
+	size_t bucket;
+
+	symbol = symbol_find(detector, step->event_type, step->message_type, &bucket);
+	if (!symbol) {
+		symbol = &detector->symbols[detector->symbol_count];
+		memset(symbol, 0, sizeof(*symbol));
+		symbol->event_type = step->event_type;
+		symbol->message_type = step->message_type;
+		detector->symbol_table[bucket] = (uint16_t)++detector->symbol_count;
+	}
+
+	refs = realloc(symbol->refs, (symbol->ref_count + 1) * sizeof(*refs));
+	if (!refs)
+		return false;
+	refs[symbol->ref_count++] = ref;
+	symbol->refs = refs;
+	return true;
+}
+
+static time_t *sequence_starts_create(size_t slots)
+{
+	time_t *starts = malloc(slots * sizeof(*starts));
+	size_t i;
+
+	for (i = 0; starts && i < slots; i++)
+		starts[i] = SEQUENCE_NONE;
+	return starts;
+}
+
+int pattern_detector_add_sequence(struct pattern_detector *detector,
+                                  const struct pattern_sequence_def *def)
+{
+	struct sequence *seq;
+	time_t *starts;
+	size_t i;
+	int id;
+
+	if (!detector || !def || def->step_count == 0 ||
+	    def->step_count > PATTERN_SEQUENCE_MAX_STEPS || def->within_sec < 0)
+		return -1;
+
+	pthread_mutex_lock(&detector->lock);
+
+	if (detector->sequence_count >= PATTERN_MAX_SEQUENCES) {
+		pthread_mutex_unlock(&detector->lock);
+		return -1;
+	}
+
+	starts = sequence_starts_create(detector->slot_count + def->step_count);
+	if (!starts) {
+		pthread_mutex_unlock(&detector->lock);
+		return -1;
+	}
+
+	id = (int)detector->sequence_count;
+	seq = &detector->sequences[id];
+	memcpy(&seq->def, def, sizeof(seq->def));
+	seq->def.name[sizeof(seq->def.name) - 1] = '\0';
+	seq->base = detector->slot_count;
+	seq->matches = 0;
+
+	/* A failed add leaves refs to the sequence in place but never counts it */
+	for (i = 0; i < def->step_count; i++) {
+		struct sequence_ref ref = {
+			.slot = (uint16_t)(seq->base + i),
+			.sequence = (uint8_t)id,
+			.step = (uint8_t)i,
+		};
+
+		if (!symbol_add_ref(detector, &def->steps[i], ref)) {
+			free(starts);
+			pthread_mutex_unlock(&detector->lock);
+			return -1;
+		}
+	}
+
+	detector->sequence_count++;
+	detector->slot_count += def->step_count;
+
+	/* Partial matches are laid out for the old slots */
+	sequence_keys_free(detector);
+	free(detector->global_starts);
+	detector->global_starts = starts;
+
+	pthread_mutex_unlock(&detector->lock);
+	return id;
+}
+
+/* FNV-1a of the interface name */
+static size_t key_bucket(const char *interface)
+{
+	uint32_t hash = 2166136261u;
+
+	for (size_t i = 0; i < 16 && interface[i]; i++) {
+		hash ^= (unsigned char)interface[i];
+		hash *= 16777619u;
+	}
+
+	return hash % SEQUENCE_KEY_BUCKETS;
+}
+
+/* Partial matches of interface, created if new, called with the lock held */
+static struct sequence_key *sequence_key(struct pattern_detector *detector,
+                                         const char *interface)
+{
+	struct sequence_key *key, **link;
+	size_t hash = key_bucket(interface);
+	size_t i;
+
+	for (key = detector->keys[hash]; key; key = key->hash_next) {
+		if (strncmp(key->interface, interface, sizeof(key->interface)) == 0)
+			break;
+	}
+
+	if (key) {
+		/* Move to the front of the LRU list */
+		if (key != detector->lru_head) {
+			key->lru_prev->lru_next = key->lru_next;
+			if (key->lru_next)
+				key->lru_next->lru_prev = key->lru_prev;
+			else
+				detector->lru_tail = key->lru_prev;
+			key->lru_prev = NULL;
+			key->lru_next = detector->lru_head;
+			detector->lru_head->lru_prev = key;
+			detector->lru_head = key;
+		}
+		return key;
+	}
+
+	/* Reuse the interface seen longest ago */
+	if (detector->key_count >= PATTERN_SEQUENCE_KEYS) {
+		key = detector->lru_tail;
+		for (link = &detector->keys[key_bucket(key->interface)]; *link != key;
+		     link = &(*link)->hash_next)
+			;
+		*link = key->hash_next;
+		detector->lru_tail = key->lru_prev;
+		detector->lru_tail->lru_next = NULL;
+		for (i = 0; i < detector->slot_count; i++)
+			key->starts[i] = SEQUENCE_NONE;
+	} else {
+		key = calloc(1, sizeof(*key));
+		if (!key)
+			return NULL;
+		key->starts = sequence_starts_create(detector->slot_count);
+		if (!key->starts) {
+			free(key);
+			return NULL;
+		}
+		detector->key_count++;
+	}
+
+	memset(key->interface, 0, sizeof(key->interface));
+	strncpy(key->interface, interface, sizeof(key->interface));
+	key->hash_next = detector->keys[hash];
+	detector->keys[hash] = key;
+	key->lru_prev = NULL;
+	key->lru_next = detector->lru_head;
+	if (detector->lru_head)
+		detector->lru_head->lru_prev = key;
+	else
+		detector->lru_tail = key;
+	detector->lru_head = key;
+	return key;
+}
+
+/* Advance the partial matches the event completes a step of */
+static size_t sequence_process(struct pattern_detector *detector, struct nlmon_event *event,
+                               struct pattern_result *results, size_t max_results,
+                               size_t found)
+{
+	const struct sequence_ref *refs[SEQUENCE_MAX_REFS];
+	const uint32_t types[4] = { event->event_type, event->event_type, 0, 0 };
+	const uint16_t messages[4] = { event->message_type, 0, event->message_type, 0 };
+	struct sequence_key *key = NULL;
+	size_t count = 0;
+	time_t now = event->timestamp;
+	size_t i, j;
+
+	/* Steps of the exact symbol and of the ones with wildcards */
+	for (i = 0; i < 4; i++) {
+		struct sequence_symbol *symbol;
+
+		if ((i & 1) && messages[0] == 0)
+			continue;
+		if (i >= 2 && types[0] == 0)
+			continue;
+
+		symbol = symbol_find(detector, types[i], messages[i], NULL);
+		for (j = 0; symbol && j < symbol->ref_count && count < SEQUENCE_MAX_REFS; j++)
+			refs[count++] = &symbol->refs[j];
+	}
+
+	/* Highest slots first */
+	for (i = 1; i < count; i++) {
+		const struct sequence_ref *ref = refs[i];
+
+		for (j = i; j > 0 && refs[j - 1]->slot < ref->slot; j--)
+			refs[j] = refs[j - 1];
+		refs[j] = ref;
+	}
+
+	for (i = 0; i < count; i++) {
+		const struct sequence_ref *ref = refs[i];
+		struct sequence *seq = &detector->sequences[ref->sequence];
+		time_t *starts, start;
+
+		if (ref->sequence >= detector->sequence_count)
+			continue;
+
+		starts = detector->global_starts;
+		if (seq->def.same_interface) {
+			if (!key)
+				key = sequence_key(detector, event->interface);
+			if (!key)
+				continue;
+			starts = key->starts;
+		}
+
+		if (ref->step == 0) {
+			start = now;
+		} else {
+			start = starts[ref->slot];
+			if (start == SEQUENCE_NONE)
+				continue;
+			if (now - start > seq->def.within_sec) {
+				starts[ref->slot] = SEQUENCE_NONE;
+				continue;
+			}
+		}
+
+		if (ref->step + 1u < seq->def.step_count) {
+			if (starts[ref->slot + 1] == SEQUENCE_NONE || starts[ref->slot + 1] < start)
+				starts[ref->slot + 1] = start;
+			continue;
+		}
+
+		/* Last step, the match is used up */
+		for (j = 1; j < seq->def.step_count; j++)
+			starts[seq->base + j] = SEQUENCE_NONE;
+		seq->matches++;
+
+		if (found < max_results) {
+			strncpy(results[found].pattern_name, seq->def.name,
+			        sizeof(results[found].pattern_name) - 1);
+			results[found].pattern_name[sizeof(results[found].pattern_name) - 1] = '\0';
+			results[found].event_type = event->event_type;
+			results[found].frequency = seq->matches;
+			results[found].first_seen = start;
+			results[found].last_seen = now;
+			results[found].events_per_second = now > start ?
+				(double)seq->def.step_count / (double)(now - start) :
+				(double)seq->def.step_count;
+			found++;
+		}
+	}
+
+	return found;
+}
+
 size_t pattern_detector_process(struct pattern_detector *detector,
                                struct nlmon_event *event,
                                struct pattern_result *results,
@@ -162,11 +535,15 @@ size_t pattern_detector_process(struct pattern_detector *detector,
 	time_window_add(detector->window, event);
 	time_window_expire(detector->window, current_time);
 
+	/* Event sequences */
+	if (detector->sequence_count)
+		found = sequence_process(detector, event, results, max_results, found);
+
 	/* Find or create pattern for this event */
 	pattern = find_pattern(detector, event->event_type, event->interface);
 	if (!pattern) {
 		pthread_mutex_unlock(&detector->lock);
-		return 0;
+		return found;
 	}
 
 	/* Update pattern statistics */
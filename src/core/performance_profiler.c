@@ -1,44 +1,74 @@
 /* performance_profiler.c - Performance profiling and bottleneck detection */
 
 #include "performance_profiler.h"
+#include "hdr_histogram.h"
+#include "stack_sampler.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
 #include <pthread.h>
 #include <time.h>
 #include <math.h>
+#include <stdatomic.h>
 
 #define DEFAULT_MAX_SAMPLES 10000
 #define DEFAULT_SLOW_THRESHOLD_MS 100.0
 #define MAX_OPERATIONS 256
 #define NS_PER_MS 1000000.0
+#define TRACE_RING_SIZE 256
+
+/* Name lookup, open addressed, twice the operations so probes stay short */
+#define OP_INDEX_SIZE (2 * MAX_OPERATIONS)
+
+/* Samples a thread can record between two aggregator passes, power of two */
+#define PROBE_RING_SIZE 4096
+#define AGGREGATE_INTERVAL_MS 20
+
+/* The tick rate is measured again once this much time has passed */
+#define CALIBRATE_MIN_NS 1000000000ULL
 
 /* Active sample (in-progress timing) */
 struct active_sample {
 	uint64_t id;
-	char operation[128];
-	char context[256];
+	int op;
 	uint64_t start_ns;
 	bool in_use;
 };
 
-/* Completed sample */
-struct completed_sample {
-	char operation[128];
-	uint64_t duration_ns;
-	time_t timestamp;
+/* Sample recorded by a probe */
+struct probe_entry {
+	uint32_t op;
+	uint32_t in_ns;       /* value is nanoseconds rather than ticks */
+	uint64_t value;
+};
+
+/* Samples of one thread, written by it and read by the aggregator */
+struct probe_ring {
+	_Atomic uint64_t head;
+	_Atomic uint64_t tail;
+	_Atomic uint64_t dropped;
+	pthread_t owner;
+	struct probe_ring *next;
+	struct probe_entry entries[PROBE_RING_SIZE];
+};
+
+/* Event kept for the Chrome trace */
+struct trace_record {
+	struct nlmon_event_trace trace;
+	bool outlier;
 };
 
 /* Operation statistics */
 struct operation_stats {
 	char name[128];
-	uint64_t *durations;  /* Array of durations in ns */
+	struct hdr_histogram *durations;   /* In ns */
 	size_t count;
-	size_t capacity;
 	uint64_t total_ns;
 	uint64_t min_ns;
 	uint64_t max_ns;
 	uint64_t slow_count;
+	double cpu_share;                  /* Percentage of the attached stack samples */
 	bool in_use;
 };
 
@@ -48,20 +78,63 @@ struct performance_profiler {
 	size_t max_active;
 	uint64_t next_sample_id;
 	
-	/* Operation statistics */
+	/* Operation statistics, an operation's id is its index */
 	struct operation_stats operations[MAX_OPERATIONS];
 	size_t num_operations;
+	_Atomic int op_index[OP_INDEX_SIZE];   /* Operation id + 1, 0 if empty */
 	
 	/* Configuration */
 	double slow_threshold_ms;
 	
+	/* Stack samples were attached since the last reset */
+	bool samples_attached;
+	
 	/* Thread safety */
 	pthread_mutex_t lock;
 	
 	/* Timing */
 	struct timespec start_time;
+	
+	/* Thread sample rings, merged by the aggregator under lock */
+	uint64_t id;
+	struct probe_ring *rings;
+	pthread_t aggregator;
+	pthread_cond_t aggregator_cond;
+	bool aggregator_running;
+	
+	/* Conversion of ticks, refined from calib_* under lock */
+	double ns_per_tick;
+	uint64_t calib_ticks;
+	uint64_t calib_ns;
+	
+	/* Event tracing, written from the pipeline threads */
+	struct hdr_histogram *stage_latency[NLMON_TRACE_STAGES];   /* In ms */
+	_Atomic uint64_t stage_slow[NLMON_TRACE_STAGES];
+	_Atomic uint64_t traced;
+	_Atomic uint64_t sampled;
+	_Atomic uint64_t outliers;
+	_Atomic uint64_t slow_threshold_ns;
+	bool tracing;
+	
+	/* Sampled and outlier events, oldest at trace_head, under lock */
+	struct trace_record trace_ring[TRACE_RING_SIZE];
+	size_t trace_head;
+	size_t trace_count;
 };
 
+/* Ring of the calling thread, for the profiler with id profiler_id */
+struct probe_cache {
+	uint64_t profiler_id;
+	struct probe_ring *ring;
+};
+
+static __thread struct probe_cache probe_cache;
+static _Atomic uint64_t next_profiler_id = 1;
+
+/* Tick rate measured once for the process */
+static pthread_once_t calibrate_once = PTHREAD_ONCE_INIT;
+static double calibrated_ns_per_tick;
+
 static uint64_t get_time_ns(void)
 {
 	struct timespec ts;
@@ -74,106 +147,376 @@ static double ns_to_ms(uint64_t ns)
 	return (double)ns / NS_PER_MS;
 }
 
-static int compare_uint64(const void *a, const void *b)
+static void calibrate(void)
+{
+#if defined(__aarch64__)
+	uint64_t freq;
+	
+	/* The generic timer reports its own frequency */
+	__asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(freq));
+	calibrated_ns_per_tick = freq ? 1e9 / (double)freq : 1.0;
+#elif defined(__x86_64__) || defined(__i386__)
+	uint64_t start_ns = get_time_ns(), start_ticks = performance_profiler_ticks();
+	uint64_t ns, ticks;
+	
+	/* A first estimate over 2ms, the aggregator refines it over seconds */
+	do {
+		ns = get_time_ns();
+		ticks = performance_profiler_ticks();
+	} while (ns - start_ns < 2000000);
+	calibrated_ns_per_tick = ticks > start_ticks ?
+	                         (double)(ns - start_ns) / (double)(ticks - start_ticks) : 1.0;
+#else
+	calibrated_ns_per_tick = 1.0;
+#endif
+}
+
+/* Measure the tick rate over the whole time since creation. Called locked. */
+static void recalibrate(struct performance_profiler *profiler)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	uint64_t ns = get_time_ns(), ticks = performance_profiler_ticks();
+	
+	if (ns - profiler->calib_ns >= CALIBRATE_MIN_NS && ticks > profiler->calib_ticks)
+		profiler->ns_per_tick = (double)(ns - profiler->calib_ns) /
+		                        (double)(ticks - profiler->calib_ticks);
+#else
+	(void)profiler;
+#endif
+}
+
+/* Hash of a name as stored, truncated to a name[] */
+static uint32_t name_hash(const char *name)
 {
-	uint64_t ua = *(const uint64_t *)a;
-	uint64_t ub = *(const uint64_t *)b;
+	uint32_t hash = 2166136261u;
 	
-	if (ua < ub) return -1;
-	if (ua > ub) return 1;
-	return 0;
+	for (size_t i = 0; name[i] && i < sizeof(((struct operation_stats *)0)->name) - 1; i++)
+		hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+	return hash;
+}
+
+/* Operation id of a name, -1 if not registered. Lock free. */
+static int lookup_operation(struct performance_profiler *profiler, const char *operation)
+{
+	uint32_t hash = name_hash(operation);
+	
+	for (size_t i = 0; i < OP_INDEX_SIZE; i++) {
+		int slot = atomic_load_explicit(&profiler->op_index[(hash + i) % OP_INDEX_SIZE],
+		                                memory_order_acquire);
+		
+		if (!slot)
+			return -1;
+		if (strncmp(profiler->operations[slot - 1].name, operation,
+		            sizeof(profiler->operations[0].name) - 1) == 0)
+			return slot - 1;
+	}
+	return -1;
+}
+
+/* Operation id of a name, registering it if needed. Called locked. */
+static int find_or_create_operation(struct performance_profiler *profiler,
+                                    const char *operation)
+{
+	struct operation_stats *op;
+	uint32_t hash;
+	int id;
+	
+	id = lookup_operation(profiler, operation);
+	if (id >= 0 || profiler->num_operations == MAX_OPERATIONS)
+		return id;
+	
+	id = profiler->num_operations;
+	op = &profiler->operations[id];
+	op->durations = hdr_histogram_create(HDR_HISTOGRAM_DEFAULT_SCHEMA);
+	if (!op->durations)
+		return -1;
+	
+	strncpy(op->name, operation, sizeof(op->name) - 1);
+	op->name[sizeof(op->name) - 1] = '\0';
+	op->count = 0;
+	op->total_ns = 0;
+	op->min_ns = UINT64_MAX;
+	op->max_ns = 0;
+	op->slow_count = 0;
+	op->in_use = true;
+	profiler->num_operations++;
+	
+	/* Published last, lookups see a complete operation */
+	hash = name_hash(op->name);
+	for (size_t i = 0; i < OP_INDEX_SIZE; i++) {
+		_Atomic int *slot = &profiler->op_index[(hash + i) % OP_INDEX_SIZE];
+		
+		if (!atomic_load_explicit(slot, memory_order_relaxed)) {
+			atomic_store_explicit(slot, id + 1, memory_order_release);
+			break;
+		}
+	}
+	
+	return id;
+}
+
+/* Add a sample to its operation. Called locked. */
+static void op_record(struct performance_profiler *profiler, int id, uint64_t duration_ns)
+{
+	struct operation_stats *op = &profiler->operations[id];
+	
+	hdr_histogram_record(op->durations, (double)duration_ns);
+	op->count++;
+	op->total_ns += duration_ns;
+	if (duration_ns < op->min_ns)
+		op->min_ns = duration_ns;
+	if (duration_ns > op->max_ns)
+		op->max_ns = duration_ns;
+	
+	if (ns_to_ms(duration_ns) > profiler->slow_threshold_ms)
+		op->slow_count++;
+}
+
+/* Merge the samples of every thread into the operations. Called locked. */
+static void drain_rings(struct performance_profiler *profiler)
+{
+	recalibrate(profiler);
+	
+	for (struct probe_ring *ring = profiler->rings; ring; ring = ring->next) {
+		uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		
+		for (; tail != head; tail++) {
+			const struct probe_entry *e = &ring->entries[tail & (PROBE_RING_SIZE - 1)];
+			uint64_t ns = e->in_ns ? e->value :
+			              (uint64_t)((double)e->value * profiler->ns_per_tick);
+			
+			op_record(profiler, e->op, ns);
+		}
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+	}
+}
+
+static void *aggregator_thread(void *arg)
+{
+	struct performance_profiler *profiler = arg;
+	struct timespec deadline;
+	
+	pthread_mutex_lock(&profiler->lock);
+	while (profiler->aggregator_running) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_nsec += AGGREGATE_INTERVAL_MS * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		
+		if (pthread_cond_timedwait(&profiler->aggregator_cond, &profiler->lock,
+		                           &deadline) == ETIMEDOUT)
+			drain_rings(profiler);
+	}
+	pthread_mutex_unlock(&profiler->lock);
+	
+	return NULL;
+}
+
+/* The calling thread's ring, created on its first sample */
+static struct probe_ring *thread_ring(struct performance_profiler *profiler)
+{
+	pthread_t self = pthread_self();
+	struct probe_ring *ring;
+	
+	if (probe_cache.profiler_id == profiler->id)
+		return probe_cache.ring;
+	
+	pthread_mutex_lock(&profiler->lock);
+	
+	/* Back after sampling for another profiler, or an exited thread's */
+	for (ring = profiler->rings; ring; ring = ring->next) {
+		if (pthread_equal(ring->owner, self))
+			break;
+	}
+	
+	if (!ring) {
+		ring = calloc(1, sizeof(*ring));
+		if (ring) {
+			ring->owner = self;
+			ring->next = profiler->rings;
+			profiler->rings = ring;
+		}
+	}
+	
+	pthread_mutex_unlock(&profiler->lock);
+	
+	if (ring) {
+		probe_cache.profiler_id = profiler->id;
+		probe_cache.ring = ring;
+	}
+	return ring;
+}
+
+static void probe_push(struct performance_profiler *profiler, int op, uint64_t value,
+                       bool in_ns)
+{
+	struct probe_ring *ring = thread_ring(profiler);
+	uint64_t head;
+	
+	if (!ring)
+		return;
+	
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == PROBE_RING_SIZE) {
+		/* Only this thread writes it */
+		atomic_store_explicit(&ring->dropped,
+		                      atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1,
+		                      memory_order_relaxed);
+		return;
+	}
+	
+	ring->entries[head & (PROBE_RING_SIZE - 1)] = (struct probe_entry){
+		.op = (uint32_t)op,
+		.in_ns = in_ns,
+		.value = value,
+	};
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
 }
 
 struct performance_profiler *performance_profiler_create(size_t max_samples,
                                                          double slow_threshold_ms)
 {
 	struct performance_profiler *profiler;
+	pthread_condattr_t cond_attr;
 	
 	if (max_samples == 0)
 		max_samples = DEFAULT_MAX_SAMPLES;
 	if (slow_threshold_ms <= 0)
 		slow_threshold_ms = DEFAULT_SLOW_THRESHOLD_MS;
 	
+	pthread_once(&calibrate_once, calibrate);
+	
 	profiler = calloc(1, sizeof(*profiler));
 	if (!profiler)
 		return NULL;
 	
 	profiler->active_samples = calloc(max_samples, sizeof(struct active_sample));
-	if (!profiler->active_samples) {
-		free(profiler);
-		return NULL;
-	}
+	if (!profiler->active_samples)
+		goto err_free;
 	
 	profiler->max_active = max_samples;
 	profiler->next_sample_id = 1;
 	profiler->slow_threshold_ms = slow_threshold_ms;
-	
+	atomic_init(&profiler->slow_threshold_ns, (uint64_t)(slow_threshold_ms * NS_PER_MS));
+	profiler->id = atomic_fetch_add_explicit(&next_profiler_id, 1, memory_order_relaxed);
+	profiler->ns_per_tick = calibrated_ns_per_tick;
+	profiler->calib_ns = get_time_ns();
+	profiler->calib_ticks = performance_profiler_ticks();
+	
+	/* The aggregator's deadlines are on the monotonic clock */
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
 	pthread_mutex_init(&profiler->lock, NULL);
+	pthread_cond_init(&profiler->aggregator_cond, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
 	clock_gettime(CLOCK_MONOTONIC, &profiler->start_time);
 	
+	profiler->aggregator_running = true;
+	if (pthread_create(&profiler->aggregator, NULL, aggregator_thread, profiler) != 0)
+		goto err_sync;
+	
 	return profiler;
+	
+err_sync:
+	pthread_cond_destroy(&profiler->aggregator_cond);
+	pthread_mutex_destroy(&profiler->lock);
+	free(profiler->active_samples);
+err_free:
+	free(profiler);
+	return NULL;
 }
 
 void performance_profiler_destroy(struct performance_profiler *profiler)
 {
+	struct probe_ring *ring;
 	size_t i;
 	
 	if (!profiler)
 		return;
 	
-	/* Free operation duration arrays */
+	performance_profiler_disable_tracing(profiler);
+	for (i = 0; i < NLMON_TRACE_STAGES; i++)
+		hdr_histogram_destroy(profiler->stage_latency[i]);
+	
+	pthread_mutex_lock(&profiler->lock);
+	profiler->aggregator_running = false;
+	pthread_cond_signal(&profiler->aggregator_cond);
+	pthread_mutex_unlock(&profiler->lock);
+	pthread_join(profiler->aggregator, NULL);
+	
+	while ((ring = profiler->rings)) {
+		profiler->rings = ring->next;
+		free(ring);
+	}
+	
+	/* Free operation histograms */
 	for (i = 0; i < MAX_OPERATIONS; i++) {
-		if (profiler->operations[i].in_use) {
-			free(profiler->operations[i].durations);
-		}
+		if (profiler->operations[i].in_use)
+			hdr_histogram_destroy(profiler->operations[i].durations);
 	}
 	
+	pthread_cond_destroy(&profiler->aggregator_cond);
 	pthread_mutex_destroy(&profiler->lock);
 	free(profiler->active_samples);
 	free(profiler);
 }
 
-static struct operation_stats *find_or_create_operation(
-	struct performance_profiler *profiler,
-	const char *operation)
+int performance_profiler_register(struct performance_profiler *profiler,
+                                  const char *operation)
 {
-	size_t i;
-	struct operation_stats *op;
+	int id;
 	
-	/* Find existing */
-	for (i = 0; i < MAX_OPERATIONS; i++) {
-		if (profiler->operations[i].in_use &&
-		    strcmp(profiler->operations[i].name, operation) == 0) {
-			return &profiler->operations[i];
-		}
-	}
+	if (!profiler || !operation)
+		return -1;
 	
-	/* Create new */
-	for (i = 0; i < MAX_OPERATIONS; i++) {
-		if (!profiler->operations[i].in_use) {
-			op = &profiler->operations[i];
-			
-			strncpy(op->name, operation, sizeof(op->name) - 1);
-			op->name[sizeof(op->name) - 1] = '\0';
-			
-			op->capacity = 1000;
-			op->durations = calloc(op->capacity, sizeof(uint64_t));
-			if (!op->durations)
-				return NULL;
-			
-			op->count = 0;
-			op->total_ns = 0;
-			op->min_ns = UINT64_MAX;
-			op->max_ns = 0;
-			op->slow_count = 0;
-			op->in_use = true;
-			
-			profiler->num_operations++;
-			return op;
-		}
-	}
+	id = lookup_operation(profiler, operation);
+	if (id >= 0)
+		return id;
 	
-	return NULL;
+	pthread_mutex_lock(&profiler->lock);
+	id = find_or_create_operation(profiler, operation);
+	pthread_mutex_unlock(&profiler->lock);
+	
+	return id;
+}
+
+void performance_profiler_probe(struct performance_profiler *profiler, int op,
+                                uint64_t start_ticks)
+{
+	uint64_t ticks = performance_profiler_ticks();
+	
+	if (!profiler || op < 0 || op >= MAX_OPERATIONS)
+		return;
+	
+	probe_push(profiler, op, ticks - start_ticks, false);
+}
+
+uint64_t performance_profiler_get_dropped(struct performance_profiler *profiler)
+{
+	uint64_t dropped = 0;
+	
+	if (!profiler)
+		return 0;
+	
+	pthread_mutex_lock(&profiler->lock);
+	for (struct probe_ring *ring = profiler->rings; ring; ring = ring->next)
+		dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+	pthread_mutex_unlock(&profiler->lock);
+	
+	return dropped;
+}
+
+void performance_profiler_flush(struct performance_profiler *profiler)
+{
+	if (!profiler)
+		return;
+	
+	pthread_mutex_lock(&profiler->lock);
+	drain_rings(profiler);
+	pthread_mutex_unlock(&profiler->lock);
 }
 
 uint64_t performance_profiler_start(struct performance_profiler *profiler,
@@ -182,8 +525,12 @@ uint64_t performance_profiler_start(struct performance_profiler *profiler,
 {
 	size_t i;
 	uint64_t sample_id;
+	int op;
 	
-	if (!profiler || !operation)
+	(void)context;
+	
+	op = performance_profiler_register(profiler, operation);
+	if (op < 0)
 		return 0;
 	
 	pthread_mutex_lock(&profiler->lock);
@@ -194,16 +541,7 @@ uint64_t performance_profiler_start(struct performance_profiler *profiler,
 			struct active_sample *sample = &profiler->active_samples[i];
 			
 			sample->id = profiler->next_sample_id++;
-			strncpy(sample->operation, operation, sizeof(sample->operation) - 1);
-			sample->operation[sizeof(sample->operation) - 1] = '\0';
-			
-			if (context) {
-				strncpy(sample->context, context, sizeof(sample->context) - 1);
-				sample->context[sizeof(sample->context) - 1] = '\0';
-			} else {
-				sample->context[0] = '\0';
-			}
-			
+			sample->op = op;
 			sample->start_ns = get_time_ns();
 			sample->in_use = true;
 			
@@ -233,38 +571,9 @@ uint64_t performance_profiler_end(struct performance_profiler *profiler,
 		if (profiler->active_samples[i].in_use &&
 		    profiler->active_samples[i].id == sample_id) {
 			struct active_sample *sample = &profiler->active_samples[i];
-			struct operation_stats *op;
-			uint64_t end_ns = get_time_ns();
 			
-			duration_ns = end_ns - sample->start_ns;
-			
-			/* Record in operation stats */
-			op = find_or_create_operation(profiler, sample->operation);
-			if (op) {
-				/* Expand array if needed */
-				if (op->count >= op->capacity) {
-					size_t new_capacity = op->capacity * 2;
-					uint64_t *new_durations = realloc(op->durations,
-					                                  new_capacity * sizeof(uint64_t));
-					if (new_durations) {
-						op->durations = new_durations;
-						op->capacity = new_capacity;
-					}
-				}
-				
-				if (op->count < op->capacity) {
-					op->durations[op->count++] = duration_ns;
-				}
-				
-				op->total_ns += duration_ns;
-				if (duration_ns < op->min_ns)
-					op->min_ns = duration_ns;
-				if (duration_ns > op->max_ns)
-					op->max_ns = duration_ns;
-				
-				if (ns_to_ms(duration_ns) > profiler->slow_threshold_ms)
-					op->slow_count++;
-			}
+			duration_ns = get_time_ns() - sample->start_ns;
+			op_record(profiler, sample->op, duration_ns);
 			
 			sample->in_use = false;
 			break;
@@ -281,96 +590,58 @@ void performance_profiler_record(struct performance_profiler *profiler,
                                  uint64_t duration_ns,
                                  const char *context)
 {
-	struct operation_stats *op;
-	
-	if (!profiler || !operation)
-		return;
+	int op;
 	
-	pthread_mutex_lock(&profiler->lock);
+	(void)context;
 	
-	op = find_or_create_operation(profiler, operation);
-	if (op) {
-		/* Expand array if needed */
-		if (op->count >= op->capacity) {
-			size_t new_capacity = op->capacity * 2;
-			uint64_t *new_durations = realloc(op->durations,
-			                                  new_capacity * sizeof(uint64_t));
-			if (new_durations) {
-				op->durations = new_durations;
-				op->capacity = new_capacity;
-			}
-		}
-		
-		if (op->count < op->capacity) {
-			op->durations[op->count++] = duration_ns;
-		}
-		
-		op->total_ns += duration_ns;
-		if (duration_ns < op->min_ns)
-			op->min_ns = duration_ns;
-		if (duration_ns > op->max_ns)
-			op->max_ns = duration_ns;
-		
-		if (ns_to_ms(duration_ns) > profiler->slow_threshold_ms)
-			op->slow_count++;
-	}
+	op = performance_profiler_register(profiler, operation);
+	if (op < 0)
+		return;
 	
-	pthread_mutex_unlock(&profiler->lock);
+	probe_push(profiler, op, duration_ns, true);
 }
 
 bool performance_profiler_get_stats(struct performance_profiler *profiler,
                                     const char *operation,
                                     struct profile_stats *stats)
 {
-	size_t i;
-	bool found = false;
+	struct operation_stats *op;
+	int id;
 	
 	if (!profiler || !operation || !stats)
 		return false;
 	
+	id = lookup_operation(profiler, operation);
+	if (id < 0)
+		return false;
+	
 	pthread_mutex_lock(&profiler->lock);
 	
-	for (i = 0; i < MAX_OPERATIONS; i++) {
-		if (profiler->operations[i].in_use &&
-		    strcmp(profiler->operations[i].name, operation) == 0) {
-			struct operation_stats *op = &profiler->operations[i];
-			uint64_t *sorted_durations;
-			
-			strncpy(stats->operation, op->name, sizeof(stats->operation) - 1);
-			stats->operation[sizeof(stats->operation) - 1] = '\0';
-			
-			stats->sample_count = op->count;
-			stats->total_time_ms = ns_to_ms(op->total_ns);
-			stats->avg_time_ms = op->count > 0 ? ns_to_ms(op->total_ns) / op->count : 0;
-			stats->min_time_ms = ns_to_ms(op->min_ns);
-			stats->max_time_ms = ns_to_ms(op->max_ns);
-			stats->slow_count = op->slow_count;
-			
-			/* Calculate percentiles */
-			if (op->count > 0) {
-				sorted_durations = malloc(op->count * sizeof(uint64_t));
-				if (sorted_durations) {
-					memcpy(sorted_durations, op->durations,
-					      op->count * sizeof(uint64_t));
-					qsort(sorted_durations, op->count, sizeof(uint64_t),
-					     compare_uint64);
-					
-					stats->p50_time_ms = ns_to_ms(sorted_durations[op->count / 2]);
-					stats->p95_time_ms = ns_to_ms(sorted_durations[(op->count * 95) / 100]);
-					stats->p99_time_ms = ns_to_ms(sorted_durations[(op->count * 99) / 100]);
-					
-					free(sorted_durations);
-				}
-			}
-			
-			found = true;
-			break;
-		}
+	drain_rings(profiler);
+	op = &profiler->operations[id];
+	
+	strncpy(stats->operation, op->name, sizeof(stats->operation) - 1);
+	stats->operation[sizeof(stats->operation) - 1] = '\0';
+	
+	stats->sample_count = op->count;
+	stats->total_time_ms = ns_to_ms(op->total_ns);
+	stats->avg_time_ms = op->count > 0 ? ns_to_ms(op->total_ns) / op->count : 0;
+	stats->min_time_ms = ns_to_ms(op->min_ns);
+	stats->max_time_ms = ns_to_ms(op->max_ns);
+	stats->slow_count = op->slow_count;
+	
+	/* Percentiles from the histogram */
+	if (op->count > 0) {
+		stats->p50_time_ms = hdr_histogram_quantile(op->durations, 0.50) / NS_PER_MS;
+		stats->p95_time_ms = hdr_histogram_quantile(op->durations, 0.95) / NS_PER_MS;
+		stats->p99_time_ms = hdr_histogram_quantile(op->durations, 0.99) / NS_PER_MS;
+	} else {
+		stats->p50_time_ms = stats->p95_time_ms = stats->p99_time_ms = 0;
 	}
 	
 	pthread_mutex_unlock(&profiler->lock);
 	
-	return found;
+	return true;
 }
 
 size_t performance_profiler_detect_bottlenecks(struct performance_profiler *profiler,
@@ -385,6 +656,7 @@ size_t performance_profiler_detect_bottlenecks(struct performance_profiler *prof
 		return 0;
 	
 	pthread_mutex_lock(&profiler->lock);
+	drain_rings(profiler);
 	
 	/* Calculate total time */
 	for (i = 0; i < MAX_OPERATIONS; i++) {
@@ -393,7 +665,7 @@ size_t performance_profiler_detect_bottlenecks(struct performance_profiler *prof
 		}
 	}
 	
-	if (total_time == 0) {
+	if (total_time == 0 && !profiler->samples_attached) {
 		pthread_mutex_unlock(&profiler->lock);
 		return 0;
 	}
@@ -402,10 +674,13 @@ size_t performance_profiler_detect_bottlenecks(struct performance_profiler *prof
 	for (i = 0; i < MAX_OPERATIONS && count < max_bottlenecks; i++) {
 		if (profiler->operations[i].in_use) {
 			struct operation_stats *op = &profiler->operations[i];
-			double percentage = (double)op->total_ns / total_time * 100.0;
+			double percentage = total_time ? (double)op->total_ns / total_time * 100.0 : 0;
 			double avg_time_ms = op->count > 0 ? ns_to_ms(op->total_ns) / op->count : 0;
 			
-			if (percentage >= threshold_percentage || avg_time_ms > profiler->slow_threshold_ms) {
+			double cpu = profiler->samples_attached ? op->cpu_share : -1;
+			
+			if (percentage >= threshold_percentage || avg_time_ms > profiler->slow_threshold_ms ||
+			    cpu >= threshold_percentage) {
 				strncpy(bottlenecks[count].operation, op->name,
 				       sizeof(bottlenecks[count].operation) - 1);
 				bottlenecks[count].operation[sizeof(bottlenecks[count].operation) - 1] = '\0';
@@ -413,6 +688,7 @@ size_t performance_profiler_detect_bottlenecks(struct performance_profiler *prof
 				bottlenecks[count].avg_time_ms = avg_time_ms;
 				bottlenecks[count].percentage_of_total = percentage;
 				bottlenecks[count].sample_count = op->count;
+				bottlenecks[count].cpu_percentage = cpu;
 				bottlenecks[count].is_bottleneck = true;
 				
 				count++;
@@ -437,6 +713,7 @@ ssize_t performance_profiler_export_json(struct performance_profiler *profiler,
 		return -1;
 	
 	pthread_mutex_lock(&profiler->lock);
+	drain_rings(profiler);
 	
 	offset += snprintf(buffer + offset, buffer_size - offset,
 	                  "{\"operations\":[");
@@ -480,6 +757,7 @@ ssize_t performance_profiler_export_csv(struct performance_profiler *profiler,
 		return -1;
 	
 	pthread_mutex_lock(&profiler->lock);
+	drain_rings(profiler);
 	
 	/* Header */
 	offset += snprintf(buffer + offset, buffer_size - offset,
@@ -513,15 +791,52 @@ void performance_profiler_reset(struct performance_profiler *profiler)
 	
 	pthread_mutex_lock(&profiler->lock);
 	
+	/* Samples recorded before the reset go with it */
+	drain_rings(profiler);
+	
 	for (i = 0; i < MAX_OPERATIONS; i++) {
 		if (profiler->operations[i].in_use) {
+			hdr_histogram_reset(profiler->operations[i].durations);
 			profiler->operations[i].count = 0;
 			profiler->operations[i].total_ns = 0;
 			profiler->operations[i].min_ns = UINT64_MAX;
 			profiler->operations[i].max_ns = 0;
 			profiler->operations[i].slow_count = 0;
+			profiler->operations[i].cpu_share = 0;
 		}
 	}
+	profiler->samples_attached = false;
+	
+	for (i = 0; i < NLMON_TRACE_STAGES; i++) {
+		if (profiler->stage_latency[i])
+			hdr_histogram_reset(profiler->stage_latency[i]);
+		atomic_store_explicit(&profiler->stage_slow[i], 0, memory_order_relaxed);
+	}
+	atomic_store_explicit(&profiler->traced, 0, memory_order_relaxed);
+	atomic_store_explicit(&profiler->sampled, 0, memory_order_relaxed);
+	atomic_store_explicit(&profiler->outliers, 0, memory_order_relaxed);
+	profiler->trace_head = 0;
+	profiler->trace_count = 0;
+	
+	pthread_mutex_unlock(&profiler->lock);
+}
+
+void performance_profiler_attach_samples(struct performance_profiler *profiler,
+                                         const struct stack_profile *profile)
+{
+	size_t i;
+	
+	if (!profiler)
+		return;
+	
+	pthread_mutex_lock(&profiler->lock);
+	
+	for (i = 0; i < MAX_OPERATIONS; i++) {
+		if (profiler->operations[i].in_use)
+			profiler->operations[i].cpu_share =
+				profile ? stack_profile_share(profile, profiler->operations[i].name) : 0;
+	}
+	profiler->samples_attached = profile != NULL;
 	
 	pthread_mutex_unlock(&profiler->lock);
 }
@@ -534,6 +849,8 @@ void performance_profiler_set_slow_threshold(struct performance_profiler *profil
 	
 	pthread_mutex_lock(&profiler->lock);
 	profiler->slow_threshold_ms = threshold_ms;
+	atomic_store_explicit(&profiler->slow_threshold_ns, (uint64_t)(threshold_ms * NS_PER_MS),
+	                      memory_order_relaxed);
 	pthread_mutex_unlock(&profiler->lock);
 }
 
@@ -546,6 +863,7 @@ double performance_profiler_get_total_time(struct performance_profiler *profiler
 		return 0;
 	
 	pthread_mutex_lock(&profiler->lock);
+	drain_rings(profiler);
 	
 	for (i = 0; i < MAX_OPERATIONS; i++) {
 		if (profiler->operations[i].in_use) {
@@ -568,6 +886,7 @@ void performance_profiler_list_operations(struct performance_profiler *profiler,
 		return;
 	
 	pthread_mutex_lock(&profiler->lock);
+	drain_rings(profiler);
 	
 	for (i = 0; i < MAX_OPERATIONS; i++) {
 		if (profiler->operations[i].in_use) {
@@ -590,3 +909,267 @@ void performance_profiler_list_operations(struct performance_profiler *profiler,
 	
 	pthread_mutex_unlock(&profiler->lock);
 }
+
+/* Keep an event for the Chrome trace, the oldest makes room. Called locked. */
+static void trace_keep(struct performance_profiler *profiler,
+                       const struct nlmon_event_trace *trace, bool outlier)
+{
+	struct trace_record *record;
+	
+	if (profiler->trace_count == TRACE_RING_SIZE) {
+		profiler->trace_head = (profiler->trace_head + 1) % TRACE_RING_SIZE;
+		profiler->trace_count--;
+	}
+	
+	record = &profiler->trace_ring[(profiler->trace_head + profiler->trace_count) %
+	                               TRACE_RING_SIZE];
+	record->trace = *trace;
+	record->outlier = outlier;
+	profiler->trace_count++;
+}
+
+/* Record of an event already kept, NULL if none. Called locked. */
+static struct trace_record *trace_find(struct performance_profiler *profiler, uint32_t id)
+{
+	/* Late stages belong to recent events, search from the newest */
+	for (size_t i = profiler->trace_count; i > 0; i--) {
+		struct trace_record *record =
+			&profiler->trace_ring[(profiler->trace_head + i - 1) % TRACE_RING_SIZE];
+		
+		if (record->trace.id == id)
+			return record;
+	}
+	return NULL;
+}
+
+/* Add a stage reached to its histogram, returns true if it was slow */
+static bool trace_record_stage(struct performance_profiler *profiler,
+                               const struct nlmon_event_trace *trace, int stage,
+                               uint64_t slow_ns)
+{
+	uint32_t offset = trace->offset_ns[stage];
+	
+	if (!offset)
+		return false;
+	
+	hdr_histogram_record(profiler->stage_latency[stage], ns_to_ms(offset));
+	if (offset <= slow_ns)
+		return false;
+	
+	atomic_fetch_add_explicit(&profiler->stage_slow[stage], 1, memory_order_relaxed);
+	return true;
+}
+
+/* Trace sink, called from the pipeline threads */
+static void trace_sink(const struct nlmon_event_trace *trace, enum nlmon_trace_stage stage,
+                       void *ctx)
+{
+	struct performance_profiler *profiler = ctx;
+	uint64_t slow_ns = atomic_load_explicit(&profiler->slow_threshold_ns, memory_order_relaxed);
+	bool sampled = trace->flags & NLMON_TRACE_SAMPLED;
+	bool outlier = false;
+	
+	if (stage == NLMON_TRACE_STAGES) {
+		/* Offsets are from receipt, any slow stage makes the event slow */
+		for (int i = 0; i < NLMON_TRACE_STAGES; i++)
+			outlier |= trace_record_stage(profiler, trace, i, slow_ns);
+		
+		atomic_fetch_add_explicit(&profiler->traced, 1, memory_order_relaxed);
+		if (sampled)
+			atomic_fetch_add_explicit(&profiler->sampled, 1, memory_order_relaxed);
+		if (outlier)
+			atomic_fetch_add_explicit(&profiler->outliers, 1, memory_order_relaxed);
+		
+		if (sampled || outlier) {
+			pthread_mutex_lock(&profiler->lock);
+			trace_keep(profiler, trace, outlier);
+			pthread_mutex_unlock(&profiler->lock);
+		}
+		return;
+	}
+	
+	/* A stage reached after the handlers, on a copy of the event */
+	outlier = trace_record_stage(profiler, trace, stage, slow_ns);
+	if (sampled || outlier) {
+		struct trace_record *record;
+		
+		pthread_mutex_lock(&profiler->lock);
+		record = trace_find(profiler, trace->id);
+		if (record) {
+			record->trace.offset_ns[stage] = trace->offset_ns[stage];
+			record->outlier |= outlier;
+		} else if (outlier) {
+			trace_keep(profiler, trace, true);
+		}
+		pthread_mutex_unlock(&profiler->lock);
+	}
+}
+
+int performance_profiler_enable_tracing(struct performance_profiler *profiler,
+                                        unsigned int sample_rate)
+{
+	size_t i;
+	
+	if (!profiler)
+		return -1;
+	
+	pthread_mutex_lock(&profiler->lock);
+	
+	for (i = 0; i < NLMON_TRACE_STAGES; i++) {
+		if (profiler->stage_latency[i])
+			continue;
+		profiler->stage_latency[i] = hdr_histogram_create(HDR_HISTOGRAM_DEFAULT_SCHEMA);
+		if (!profiler->stage_latency[i]) {
+			pthread_mutex_unlock(&profiler->lock);
+			return -1;
+		}
+	}
+	
+	profiler->tracing = true;
+	nlmon_trace_set_sink(trace_sink, profiler, sample_rate);
+	
+	pthread_mutex_unlock(&profiler->lock);
+	
+	return 0;
+}
+
+void performance_profiler_disable_tracing(struct performance_profiler *profiler)
+{
+	if (!profiler)
+		return;
+	
+	pthread_mutex_lock(&profiler->lock);
+	if (profiler->tracing) {
+		profiler->tracing = false;
+		nlmon_trace_set_sink(NULL, NULL, 0);
+	}
+	pthread_mutex_unlock(&profiler->lock);
+}
+
+bool performance_profiler_get_trace_stats(struct performance_profiler *profiler,
+                                          struct trace_stats *stats)
+{
+	if (!profiler || !stats)
+		return false;
+	
+	memset(stats, 0, sizeof(*stats));
+	
+	pthread_mutex_lock(&profiler->lock);
+	
+	stats->traced = atomic_load_explicit(&profiler->traced, memory_order_relaxed);
+	stats->sampled = atomic_load_explicit(&profiler->sampled, memory_order_relaxed);
+	stats->outliers = atomic_load_explicit(&profiler->outliers, memory_order_relaxed);
+	
+	for (int i = 0; i < NLMON_TRACE_STAGES; i++) {
+		struct hdr_histogram *h = profiler->stage_latency[i];
+		struct trace_stage_stats *stage = &stats->stages[i];
+		
+		if (!h || !hdr_histogram_count(h))
+			continue;
+		
+		stage->count = hdr_histogram_count(h);
+		stage->p50_ms = hdr_histogram_quantile(h, 0.50);
+		stage->p95_ms = hdr_histogram_quantile(h, 0.95);
+		stage->p99_ms = hdr_histogram_quantile(h, 0.99);
+		stage->max_ms = hdr_histogram_max(h);
+		stage->slow_count = atomic_load_explicit(&profiler->stage_slow[i],
+		                                         memory_order_relaxed);
+	}
+	
+	pthread_mutex_unlock(&profiler->lock);
+	
+	return true;
+}
+
+/* Write one event's stages in the order they were reached, -1 if it does not fit */
+static int chrome_trace_event(const struct trace_record *record, char *buffer, size_t size)
+{
+	const struct nlmon_event_trace *trace = &record->trace;
+	int order[NLMON_TRACE_STAGES];
+	int n = 0, len;
+	uint32_t prev = 0;
+	size_t offset;
+	
+	for (int i = 0; i < NLMON_TRACE_STAGES; i++) {
+		int j;
+		
+		if (!trace->offset_ns[i])
+			continue;
+		for (j = n++; j > 0 && trace->offset_ns[order[j - 1]] > trace->offset_ns[i]; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+	if (!n)
+		return 0;
+	
+	/* The whole event, then each stage from the one before */
+	len = snprintf(buffer, size,
+	               "{\"name\":\"event\",\"cat\":\"nlmon\",\"ph\":\"X\",\"ts\":%.3f,"
+	               "\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"outlier\":%s}}",
+	               trace->recv_ns / 1000.0, trace->offset_ns[order[n - 1]] / 1000.0,
+	               trace->id, record->outlier ? "true" : "false");
+	if (len < 0 || (size_t)len >= size)
+		return -1;
+	offset = len;
+	
+	for (int i = 0; i < n; i++) {
+		uint32_t at = trace->offset_ns[order[i]];
+		
+		if (order[i] == NLMON_TRACE_RECV)
+			continue;
+		
+		len = snprintf(buffer + offset, size - offset,
+		               ",{\"name\":\"%s\",\"cat\":\"nlmon\",\"ph\":\"X\",\"ts\":%.3f,"
+		               "\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+		               nlmon_trace_stage_name(order[i]),
+		               (trace->recv_ns + prev) / 1000.0, (at - prev) / 1000.0, trace->id);
+		if (len < 0 || (size_t)len >= size - offset)
+			return -1;
+		offset += len;
+		prev = at;
+	}
+	
+	return offset;
+}
+
+ssize_t performance_profiler_export_chrome_trace(struct performance_profiler *profiler,
+                                                 char *buffer,
+                                                 size_t buffer_size)
+{
+	static const char head[] = "{\"traceEvents\":[";
+	static const char tail[] = "],\"displayTimeUnit\":\"ns\"}";
+	size_t offset = sizeof(head) - 1;
+	size_t i;
+	
+	if (!profiler || !buffer || buffer_size < sizeof(head) + sizeof(tail))
+		return -1;
+	
+	pthread_mutex_lock(&profiler->lock);
+	
+	memcpy(buffer, head, offset);
+	
+	for (i = 0; i < profiler->trace_count; i++) {
+		const struct trace_record *record =
+			&profiler->trace_ring[(profiler->trace_head + i) % TRACE_RING_SIZE];
+		size_t room = buffer_size - offset - sizeof(tail);
+		size_t sep = offset > sizeof(head) - 1;
+		int len;
+		
+		/* Leave out the events that do not fit */
+		if (room <= sep)
+			break;
+		len = chrome_trace_event(record, buffer + offset + sep, room - sep);
+		if (len <= 0)
+			break;
+		if (sep)
+			buffer[offset] = ',';
+		offset += sep + len;
+	}
+	
+	memcpy(buffer + offset, tail, sizeof(tail));
+	offset += sizeof(tail) - 1;
+	
+	pthread_mutex_unlock(&profiler->lock);
+	
+	return offset;
+}
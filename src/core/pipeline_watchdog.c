@@ -0,0 +1,374 @@
+/* pipeline_watchdog.c - Stall detection of the pipeline threads
+ *
+ * Slots live in a static table so that a thread's slot stays put while
+ * the watchdog reads it. The lock is held for a whole scan: a thread
+ * cannot unregister and exit while its stack is being captured, which
+ * keeps its tid valid for the signal.
+ *
+ * The stack is taken by the stalled thread itself, in a SIGURG handler
+ * that only calls backtrace() into its slot. SIGURG is ignored by
+ * default, so one arriving at a thread that no longer expects it is
+ * harmless.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include <sys/syscall.h>
+#include "pipeline_watchdog.h"
+#include "thread_affinity.h"
+
+#define DEFAULT_STALL_MS 5000
+#define CAPTURE_WAIT_MS 100
+#define NAME_LEN 32
+
+/* Frames of the handler and the signal trampoline */
+#define SKIP_FRAMES 2
+
+/* Slot of a thread, the heartbeat first on its own line */
+struct watchdog_slot {
+	struct nlmon_heartbeat hb;
+	
+	/* Written under the lock */
+	bool used;
+	char name[NAME_LEN];
+	pid_t tid;
+	nlmon_heartbeat_restart_fn restart;
+	void *ctx;
+	uint64_t seen_progress;
+	uint64_t seen_ms;               /* When progress last moved */
+	bool stalled;
+	uint64_t stalls;
+	uint64_t restarts;
+	
+	/* Stack capture, the frames written by the thread's handler */
+	_Atomic bool capture;
+	_Atomic bool captured;
+	int depth;
+	void *frames[WATCHDOG_MAX_FRAMES + SKIP_FRAMES];
+};
+
+__thread struct nlmon_heartbeat *nlmon_heartbeat_self;
+
+static struct watchdog_slot slots[WATCHDOG_MAX_THREADS];
+static pthread_mutex_t slots_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t handler_once = PTHREAD_ONCE_INIT;
+
+/* Watchdog thread */
+static pthread_mutex_t run_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t run_cond = PTHREAD_COND_INITIALIZER;
+static struct nlmon_watchdog_config run_config;
+static pthread_t run_thread;
+static bool running;
+static bool stopping;
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void capture_handler(int sig)
+{
+	struct watchdog_slot *slot = (struct watchdog_slot *)nlmon_heartbeat_self;
+	int saved_errno = errno;
+	
+	(void)sig;
+	if (slot && atomic_load_explicit(&slot->capture, memory_order_acquire)) {
+		slot->depth = backtrace(slot->frames, WATCHDOG_MAX_FRAMES + SKIP_FRAMES);
+		atomic_store_explicit(&slot->captured, true, memory_order_release);
+	}
+	errno = saved_errno;
+}
+
+static void install_handler(void)
+{
+	struct sigaction action;
+	void *prime[4];
+	
+	/* The first backtrace() loads the unwinder, which the handler must not */
+	backtrace(prime, 4);
+	
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = capture_handler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGURG, &action, NULL);
+}
+
+struct nlmon_heartbeat *nlmon_heartbeat_register(const char *name,
+                                                 nlmon_heartbeat_restart_fn restart,
+                                                 void *ctx)
+{
+	struct watchdog_slot *slot = NULL;
+	
+	if (nlmon_heartbeat_self)
+		return nlmon_heartbeat_self;
+	
+	pthread_mutex_lock(&slots_lock);
+	for (size_t i = 0; i < WATCHDOG_MAX_THREADS; i++) {
+		if (!slots[i].used) {
+			slot = &slots[i];
+			break;
+		}
+	}
+	if (slot) {
+		memset(slot, 0, sizeof(*slot));
+		snprintf(slot->name, sizeof(slot->name), "%s", name ? name : "");
+		slot->tid = (pid_t)syscall(SYS_gettid);
+		slot->restart = restart;
+		slot->ctx = ctx;
+		slot->seen_ms = now_ms();
+		slot->used = true;
+		nlmon_heartbeat_self = &slot->hb;
+	}
+	pthread_mutex_unlock(&slots_lock);
+	
+	return slot ? &slot->hb : NULL;
+}
+
+void nlmon_heartbeat_unregister(void)
+{
+	struct watchdog_slot *slot = (struct watchdog_slot *)nlmon_heartbeat_self;
+	
+	if (!slot)
+		return;
+	
+	pthread_mutex_lock(&slots_lock);
+	slot->used = false;
+	nlmon_heartbeat_self = NULL;
+	pthread_mutex_unlock(&slots_lock);
+}
+
+/* Have the thread of a slot record its stack, false if it did not in time */
+static bool capture_stack(struct watchdog_slot *slot)
+{
+	struct timespec pause = { .tv_nsec = 1000000 };
+	
+	atomic_store_explicit(&slot->captured, false, memory_order_relaxed);
+	atomic_store_explicit(&slot->capture, true, memory_order_release);
+	if (syscall(SYS_tgkill, getpid(), slot->tid, SIGURG) < 0) {
+		atomic_store_explicit(&slot->capture, false, memory_order_relaxed);
+		return false;
+	}
+	
+	for (int i = 0; i < CAPTURE_WAIT_MS; i++) {
+		if (atomic_load_explicit(&slot->captured, memory_order_acquire))
+			break;
+		nanosleep(&pause, NULL);
+	}
+	atomic_store_explicit(&slot->capture, false, memory_order_relaxed);
+	
+	return atomic_load_explicit(&slot->captured, memory_order_acquire) &&
+	       slot->depth > SKIP_FRAMES;
+}
+
+/* Symbolized frames of a captured stack, one per line */
+static char *format_stack(struct watchdog_slot *slot)
+{
+	int depth = slot->depth - SKIP_FRAMES;
+	char **symbols = backtrace_symbols(slot->frames + SKIP_FRAMES, depth);
+	size_t len = 0, size = 0;
+	char *text;
+	
+	if (!symbols)
+		return NULL;
+	
+	for (int i = 0; i < depth; i++)
+		size += strlen(symbols[i]) + 8;
+	text = malloc(size + 1);
+	if (text) {
+		text[0] = '\0';
+		for (int i = 0; i < depth; i++)
+			len += snprintf(text + len, size + 1 - len, "#%-2d %s\n", i, symbols[i]);
+	}
+	free(symbols);
+	
+	return text;
+}
+
+static void report_stall(struct watchdog_slot *slot, const char *stage,
+                         const struct nlmon_watchdog_config *config, uint64_t now)
+{
+	struct nlmon_stall stall = {
+		.name = slot->name,
+		.tid = slot->tid,
+		.stage = stage,
+		.stalled_ms = now - slot->seen_ms,
+	};
+	char *stack = NULL;
+	
+	slot->stalled = true;
+	slot->stalls++;
+	
+	if (capture_stack(slot))
+		stack = format_stack(slot);
+	stall.stack = stack;
+	
+	if (config->restart && slot->restart && slot->restart(slot->ctx)) {
+		slot->restarts++;
+		stall.restarted = true;
+	}
+	
+	if (config->on_stall)
+		config->on_stall(&stall, config->ctx);
+	free(stack);
+}
+
+unsigned int nlmon_watchdog_check(const struct nlmon_watchdog_config *config)
+{
+	unsigned int stall_ms = config->stall_ms ? config->stall_ms : DEFAULT_STALL_MS;
+	unsigned int found = 0;
+	uint64_t now;
+	
+	pthread_once(&handler_once, install_handler);
+	
+	pthread_mutex_lock(&slots_lock);
+	now = now_ms();
+	for (size_t i = 0; i < WATCHDOG_MAX_THREADS; i++) {
+		struct watchdog_slot *slot = &slots[i];
+		uint64_t progress;
+		const char *stage;
+	
+		if (!slot->used)
+			continue;
+	
+		progress = atomic_load_explicit(&slot->hb.progress, memory_order_acquire);
+		stage = atomic_load_explicit(&slot->hb.stage, memory_order_relaxed);
+		if (progress != slot->seen_progress || !stage) {
+			slot->seen_progress = progress;
+			slot->seen_ms = now;
+			slot->stalled = false;
+			continue;
+		}
+	
+		if (slot->stalled || now - slot->seen_ms < stall_ms)
+			continue;
+	
+		report_stall(slot, stage, config, now);
+		found++;
+	}
+	pthread_mutex_unlock(&slots_lock);
+	
+	return found;
+}
+
+static void *watchdog_thread(void *arg)
+{
+	unsigned int interval_ms = run_config.interval_ms;
+	struct timespec deadline;
+	
+	(void)arg;
+	if (!interval_ms)
+		interval_ms = (run_config.stall_ms ? run_config.stall_ms : DEFAULT_STALL_MS) / 4;
+	
+	pthread_mutex_lock(&run_lock);
+	while (!stopping) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += interval_ms / 1000;
+		deadline.tv_nsec += (long)(interval_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		if (pthread_cond_timedwait(&run_cond, &run_lock, &deadline) != ETIMEDOUT)
+			continue;
+	
+		pthread_mutex_unlock(&run_lock);
+		nlmon_watchdog_check(&run_config);
+		pthread_mutex_lock(&run_lock);
+	}
+	pthread_mutex_unlock(&run_lock);
+	
+	return NULL;
+}
+
+int nlmon_watchdog_start(const struct nlmon_watchdog_config *config)
+{
+	pthread_condattr_t attr;
+	int ret = -1;
+	
+	if (!config)
+		return -1;
+	
+	pthread_mutex_lock(&run_lock);
+	if (running)
+		goto out;
+	
+	/* Waits are timed on CLOCK_MONOTONIC */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_destroy(&run_cond);
+	pthread_cond_init(&run_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	
+	run_config = *config;
+	stopping = false;
+	if (pthread_create(&run_thread, NULL, watchdog_thread, NULL) != 0)
+		goto out;
+	thread_affinity_apply(run_thread, NULL, -1, "watchdog");
+	running = true;
+	ret = 0;
+out:
+	pthread_mutex_unlock(&run_lock);
+	return ret;
+}
+
+void nlmon_watchdog_stop(void)
+{
+	pthread_mutex_lock(&run_lock);
+	if (!running) {
+		pthread_mutex_unlock(&run_lock);
+		return;
+	}
+	stopping = true;
+	pthread_cond_signal(&run_cond);
+	pthread_mutex_unlock(&run_lock);
+	
+	pthread_join(run_thread, NULL);
+	
+	pthread_mutex_lock(&run_lock);
+	running = false;
+	pthread_mutex_unlock(&run_lock);
+}
+
+void nlmon_watchdog_for_each(void (*fn)(const struct nlmon_heartbeat_stats *stats, void *ctx),
+                             void *ctx)
+{
+	char name[NAME_LEN];
+	struct nlmon_heartbeat_stats stats = { .name = name };
+	
+	if (!fn)
+		return;
+	
+	/* Copied out one at a time so that fn can take other locks */
+	for (size_t i = 0; i < WATCHDOG_MAX_THREADS; i++) {
+		struct watchdog_slot *slot = &slots[i];
+		bool used;
+	
+		pthread_mutex_lock(&slots_lock);
+		used = slot->used;
+		if (used) {
+			memcpy(name, slot->name, sizeof(name));
+			stats.tid = slot->tid;
+			stats.stage = atomic_load_explicit(&slot->hb.stage, memory_order_relaxed);
+			stats.progress = atomic_load_explicit(&slot->hb.progress, memory_order_relaxed);
+			stats.stalled = slot->stalled;
+			stats.stalls = slot->stalls;
+			stats.restarts = slot->restarts;
+		}
+		pthread_mutex_unlock(&slots_lock);
+	
+		if (used)
+			fn(&stats, ctx);
+	}
+}
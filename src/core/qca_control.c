@@ -10,6 +10,8 @@
 #include <string.h>
 #include <errno.h>
 #include <net/if.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 #include <netlink/netlink.h>
 #include <netlink/genl/genl.h>
 #include <netlink/genl/ctrl.h>
@@ -17,47 +19,177 @@
 
 #include "qca_control.h"
 
+/* A command in flight until its ack or error */
+struct qca_request {
+	uint32_t seq;
+	int *result;
+	qca_response_cb_t response_cb;
+	void *user_data;
+};
+
+struct qca_session {
+	struct nl_sock *sock;
+	struct nl_cb *cb;
+	int nl80211_id;
+	unsigned int pending;
+	unsigned int progress;          /* Messages matched, to spot timeouts */
+	unsigned int failed;
+	struct qca_request requests[QCA_SESSION_MAX_PENDING];
+};
+
+static struct qca_request *find_request(struct qca_session *session, uint32_t seq)
+{
+	for (unsigned int i = 0; i < session->pending; i++)
+		if (session->requests[i].seq == seq)
+			return &session->requests[i];
+	return NULL;
+}
+
+/* Retire a request, the last one in flight takes its slot */
+static void complete_request(struct qca_session *session, struct qca_request *req, int error)
+{
+	if (req->result)
+		*req->result = error;
+	if (error)
+		session->failed++;
+	*req = session->requests[--session->pending];
+}
+
+/* Responses arrive in any order, each request is found by its sequence number */
+static int session_seq_check(struct nl_msg *msg, void *arg)
+{
+	(void)msg;
+	(void)arg;
+	return NL_OK;
+}
+
+static int session_valid(struct nl_msg *msg, void *arg)
+{
+	struct qca_session *session = arg;
+	struct qca_request *req = find_request(session, nlmsg_hdr(msg)->nlmsg_seq);
+	
+	if (!req)
+		return NL_SKIP;
+	session->progress++;
+	if (req->response_cb)
+		req->response_cb(msg, req->user_data);
+	return NL_OK;
+}
+
+static int session_ack(struct nl_msg *msg, void *arg)
+{
+	struct qca_session *session = arg;
+	struct qca_request *req = find_request(session, nlmsg_hdr(msg)->nlmsg_seq);
+	
+	if (req) {
+		session->progress++;
+		complete_request(session, req, 0);
+	}
+	return NL_OK;
+}
+
+static int session_error(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg)
+{
+	struct qca_session *session = arg;
+	struct qca_request *req = find_request(session, err->msg.nlmsg_seq);
+	
+	(void)nla;
+	
+	if (req) {
+		session->progress++;
+		complete_request(session, req, err->error);
+	}
+	return NL_SKIP;
+}
+
 /**
- * Send QCA vendor command
+ * Open a control session
  */
-int qca_send_vendor_command(const char *ifname,
-                            uint32_t subcmd,
-                            const void *data,
-                            size_t data_len,
-                            qca_response_cb_t response_cb,
-                            void *user_data)
+struct qca_session *qca_session_open(void)
 {
-	struct nl_sock *sock = NULL;
-	struct nl_msg *msg = NULL;
-	struct nl_cb *cb = NULL;
-	int nl80211_id, ifindex;
-	int ret = -1;
-	int err = 1;
+	struct timeval timeout = {
+		.tv_sec = QCA_SESSION_TIMEOUT_MS / 1000,
+		.tv_usec = (QCA_SESSION_TIMEOUT_MS % 1000) * 1000,
+	};
+	struct qca_session *session;
+	
+	session = calloc(1, sizeof(*session));
+	if (!session)
+		return NULL;
+	
+	session->sock = nl_socket_alloc();
+	session->cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (!session->sock || !session->cb || genl_connect(session->sock) < 0)
+		goto fail;
 	
-	/* Create socket */
-	sock = nl_socket_alloc();
-	if (!sock)
-		goto out;
+	session->nl80211_id = genl_ctrl_resolve(session->sock, "nl80211");
+	if (session->nl80211_id < 0)
+		goto fail;
 	
-	if (genl_connect(sock) < 0)
-		goto out;
+	/* Room for the responses of a full window, and a bounded wait */
+	nl_socket_set_buffer_size(session->sock, 0, 1 << 20);
+	setsockopt(nl_socket_get_fd(session->sock), SOL_SOCKET, SO_RCVTIMEO,
+	           &timeout, sizeof(timeout));
 	
-	/* Resolve nl80211 */
-	nl80211_id = genl_ctrl_resolve(sock, "nl80211");
-	if (nl80211_id < 0)
-		goto out;
+	nl_cb_set(session->cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, session_seq_check, NULL);
+	nl_cb_set(session->cb, NL_CB_VALID, NL_CB_CUSTOM, session_valid, session);
+	nl_cb_set(session->cb, NL_CB_ACK, NL_CB_CUSTOM, session_ack, session);
+	nl_cb_err(session->cb, NL_CB_CUSTOM, session_error, session);
+	return session;
+	
+fail:
+	qca_session_close(session);
+	return NULL;
+}
+
+/**
+ * Close a control session
+ */
+void qca_session_close(struct qca_session *session)
+{
+	if (!session)
+		return;
+	if (session->cb)
+		nl_cb_put(session->cb);
+	if (session->sock)
+		nl_socket_free(session->sock);
+	free(session);
+}
+
+/**
+ * Send a vendor command without waiting for it
+ */
+int qca_session_submit(struct qca_session *session,
+                       const char *ifname,
+                       uint32_t subcmd,
+                       const void *data,
+                       size_t data_len,
+                       qca_response_cb_t response_cb,
+                       void *user_data,
+                       int *error)
+{
+	struct qca_request *req;
+	struct nl_msg *msg;
+	unsigned int ifindex;
+	
+	if (error)
+		*error = -EINPROGRESS;
 	
-	/* Get interface index */
 	ifindex = if_nametoindex(ifname);
-	if (ifindex == 0)
-		goto out;
+	if (ifindex == 0) {
+		if (error)
+			*error = -ENODEV;
+		return -1;
+	}
+	
+	if (session->pending == QCA_SESSION_MAX_PENDING && qca_session_wait(session) < 0)
+		return -1;
 	
-	/* Build message */
 	msg = nlmsg_alloc();
 	if (!msg)
-		goto out;
+		return -1;
 	
-	genlmsg_put(msg, 0, 0, nl80211_id, 0, 0, NL80211_CMD_VENDOR, 0);
+	genlmsg_put(msg, 0, 0, session->nl80211_id, 0, 0, NL80211_CMD_VENDOR, 0);
 	nla_put_u32(msg, NL80211_ATTR_IFINDEX, ifindex);
 	nla_put_u32(msg, NL80211_ATTR_VENDOR_ID, QCA_NL80211_VENDOR_ID);
 	nla_put_u32(msg, NL80211_ATTR_VENDOR_SUBCMD, subcmd);
@@ -65,37 +197,103 @@ int qca_send_vendor_command(const char *ifname,
 	if (data && data_len > 0)
 		nla_put(msg, NL80211_ATTR_VENDOR_DATA, data_len, data);
 	
-	/* Set up callback if provided */
-	if (response_cb) {
-		cb = nl_cb_alloc(NL_CB_DEFAULT);
-		if (!cb)
-			goto out;
+	/* Completion is the ack the auto completed request asks for */
+	if (nl_send_auto_complete(session->sock, msg) < 0) {
+		nlmsg_free(msg);
+		return -1;
+	}
+	
+	req = &session->requests[session->pending++];
+	req->seq = nlmsg_hdr(msg)->nlmsg_seq;
+	req->result = error;
+	req->response_cb = response_cb;
+	req->user_data = user_data;
+	
+	nlmsg_free(msg);
+	return 0;
+}
+
+/**
+ * Wait for every command in flight
+ */
+int qca_session_wait(struct qca_session *session)
+{
+	int failed, err;
+	
+	while (session->pending > 0) {
+		unsigned int progress = session->progress;
+		
+		err = nl_recvmsgs(session->sock, session->cb);
+		if (err < 0)
+			return -1;
 		
-		nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, response_cb, user_data);
-		nl_cb_err(cb, NL_CB_CUSTOM, NULL, &err);
+		/* An empty read is the receive timeout */
+		if (err == 0 && progress == session->progress) {
+			while (session->pending > 0)
+				complete_request(session, &session->requests[0], -ETIMEDOUT);
+		}
 	}
 	
-	/* Send */
-	ret = nl_send_auto_complete(sock, msg);
-	if (ret < 0)
-		goto out;
+	failed = session->failed;
+	session->failed = 0;
+	return failed;
+}
+
+/**
+ * Get link layer statistics of several interfaces in one round trip
+ */
+int qca_session_get_link_stats(struct qca_session *session,
+                               const char *const *ifnames,
+                               size_t count,
+                               qca_response_cb_t callback,
+                               void *user_data,
+                               int *errors)
+{
+	struct {
+		uint32_t req_id;
+		uint32_t req_mask;
+	} __attribute__((packed)) req = {
+		.req_id = 1,
+		.req_mask = 0x7  /* Radio + Iface + Peer */
+	};
+	int unsent = 0, failed;
 	
-	/* Wait for response if callback provided */
-	if (response_cb) {
-		while (err > 0)
-			nl_recvmsgs(sock, cb);
+	for (size_t i = 0; i < count; i++) {
+		if (qca_session_submit(session, ifnames[i],
+		                       QCA_NL80211_VENDOR_SUBCMD_LL_STATS_GET,
+		                       &req, sizeof(req), callback, user_data,
+		                       errors ? &errors[i] : NULL) < 0)
+			unsent++;
 	}
 	
-	ret = 0;
+	failed = qca_session_wait(session);
+	return failed < 0 ? -1 : failed + unsent;
+}
+
+/**
+ * Send QCA vendor command
+ */
+int qca_send_vendor_command(const char *ifname,
+                            uint32_t subcmd,
+                            const void *data,
+                            size_t data_len,
+                            qca_response_cb_t response_cb,
+                            void *user_data)
+{
+	struct qca_session *session;
+	int ret = -1;
+	
+	session = qca_session_open();
+	if (!session)
+		return -1;
 	
-out:
-	if (cb)
-		nl_cb_put(cb);
-	if (msg)
-		nlmsg_free(msg);
-	if (sock)
-		nl_socket_free(sock);
+	/* Without a callback nobody waits for the outcome, as before */
+	if (qca_session_submit(session, ifname, subcmd, data, data_len,
+	                       response_cb, user_data, NULL) == 0 &&
+	    (!response_cb || qca_session_wait(session) == 0))
+		ret = 0;
 	
+	qca_session_close(session);
 	return ret;
 }
 
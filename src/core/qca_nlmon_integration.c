@@ -10,11 +10,19 @@
 #include <string.h>
 #include <errno.h>
 #include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <net/if.h>
 #include <linux/netlink.h>
+#include <linux/nl80211.h>
+#include <netlink/attr.h>
+#include <netlink/genl/genl.h>
 
 #include "qca_control.h"
+#include "qca_nlmon_integration.h"
 #include "event_processor.h"
 #include "nlmon_nl_genl.h"
+#include "nlmon_clock.h"
 
 /* Integration configuration */
 struct qca_nlmon_config {
@@ -278,3 +286,338 @@ void qca_nlmon_cleanup(void)
 		syslog(LOG_INFO, "QCA-nlmon integration cleanup");
 	}
 }
+
+/* Bits per attribute type in a counter key, deeper types are skipped */
+#define STATS_KEY_BITS 10
+
+/* Counter of an interface, kept sorted by key */
+struct stats_value {
+	uint64_t key;
+	uint64_t value;
+	uint32_t generation;         /* Last poll that saw it */
+};
+
+struct stats_slot {
+	char ifname[IFNAMSIZ];
+	unsigned int ifindex;
+	unsigned int replies;        /* Replies of the current poll */
+	size_t count;
+	struct stats_value values[QCA_STATS_MAX_COUNTERS];
+};
+
+struct qca_stats_poller {
+	struct qca_session *session;
+	qca_stats_sink_t sink;
+	void *user_data;
+	unsigned int interval_ms;
+	unsigned int jitter_pct;
+	unsigned int seed;
+	uint32_t generation;
+	uint64_t sequence;
+	size_t count;
+	size_t changed;              /* Entries of changed for the current reply */
+	struct qca_stats_counter changed_counters[QCA_STATS_MAX_COUNTERS];
+	struct stats_slot slots[QCA_STATS_MAX_INTERFACES];
+};
+
+/* Unflagged nests are told by being one or more attributes filling the payload */
+static int is_nested(struct nlattr *head, int len)
+{
+	struct nlattr *nla;
+	int rem;
+	
+	if (len < NLA_HDRLEN)
+		return 0;
+	nla_for_each_attr(nla, head, len, rem)
+		;
+	return rem == 0;
+}
+
+static struct stats_value *find_value(struct stats_slot *slot, uint64_t key, size_t *pos)
+{
+	size_t lo = 0, hi = slot->count;
+	
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		
+		if (slot->values[mid].key == key)
+			return &slot->values[mid];
+		if (slot->values[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*pos = lo;
+	return NULL;
+}
+
+/* New counters start their baseline, known ones report what changed */
+static void update_counter(struct qca_stats_poller *poller, struct stats_slot *slot,
+                           uint64_t key, uint64_t value, int size)
+{
+	struct stats_value *old;
+	struct qca_stats_counter *counter;
+	size_t pos;
+	
+	old = find_value(slot, key, &pos);
+	if (!old) {
+		if (slot->count == QCA_STATS_MAX_COUNTERS)
+			return;
+		memmove(&slot->values[pos + 1], &slot->values[pos],
+		        (slot->count - pos) * sizeof(slot->values[0]));
+		slot->count++;
+		slot->values[pos].key = key;
+		slot->values[pos].value = value;
+		slot->values[pos].generation = poller->generation;
+		return;
+	}
+	
+	old->generation = poller->generation;
+	if (old->value == value)
+		return;
+	
+	counter = &poller->changed_counters[poller->changed++];
+	counter->key = key;
+	counter->value = value;
+	counter->delta = size == 4 ? (int32_t)(uint32_t)(value - old->value) :
+	                             (int64_t)(value - old->value);
+	old->value = value;
+}
+
+static void walk_counters(struct qca_stats_poller *poller, struct stats_slot *slot,
+                          uint64_t prefix, struct nlattr *head, int len, int depth)
+{
+	struct nlattr *nla;
+	int rem;
+	
+	nla_for_each_attr(nla, head, len, rem) {
+		int type = nla_type(nla);
+		uint64_t key;
+		
+		if (type >= 1 << STATS_KEY_BITS)
+			continue;
+		key = (prefix & ~(3ULL << 30)) | (uint64_t)(depth + 1) << 30 |
+		      (uint64_t)type << (STATS_KEY_BITS * (QCA_STATS_MAX_DEPTH - 1 - depth));
+		
+		if (nla->nla_type & NLA_F_NESTED) {
+			if (depth + 1 < QCA_STATS_MAX_DEPTH)
+				walk_counters(poller, slot, key, nla_data(nla), nla_len(nla), depth + 1);
+			continue;
+		}
+		
+		switch (nla_len(nla)) {
+		case 4:
+			update_counter(poller, slot, key, nla_get_u32(nla), 4);
+			break;
+		case 8:
+			update_counter(poller, slot, key, nla_get_u64(nla), 8);
+			break;
+		default:
+			/* Strings, addresses and the like are no counters */
+			if (depth + 1 < QCA_STATS_MAX_DEPTH && is_nested(nla_data(nla), nla_len(nla)))
+				walk_counters(poller, slot, key, nla_data(nla), nla_len(nla), depth + 1);
+			break;
+		}
+	}
+}
+
+static int update_slot(struct qca_stats_poller *poller, struct stats_slot *slot,
+                       unsigned int reply, const void *data, size_t len)
+{
+	struct nlmon_event event;
+	
+	poller->changed = 0;
+	walk_counters(poller, slot, (uint64_t)(reply & 0xffff) << 32,
+	              (struct nlattr *)data, (int)len, 0);
+	if (!poller->changed)
+		return 0;
+	
+	memset(&event, 0, sizeof(event));
+	event.timestamp = nlmon_clock_realtime_ns();
+	event.sequence = ++poller->sequence;
+	event.event_type = QCA_NLMON_EVENT_LINK_STATS;
+	event.message_type = QCA_NL80211_VENDOR_SUBCMD_LL_STATS_GET;
+	memcpy(event.interface, slot->ifname, sizeof(event.interface));
+	event.interface[sizeof(event.interface) - 1] = '\0';
+	event.data = poller->changed_counters;
+	event.data_size = poller->changed * sizeof(poller->changed_counters[0]);
+	event.user_data = poller->user_data;
+	event.netlink.protocol = NETLINK_GENERIC;
+	event.netlink.genl_cmd = NL80211_CMD_VENDOR;
+	snprintf(event.netlink.genl_family_name, sizeof(event.netlink.genl_family_name), "nl80211");
+	
+	if (poller->sink)
+		poller->sink(&event, poller->user_data);
+	return (int)poller->changed;
+}
+
+/* Counters of peers gone or replies no longer sent make room for new ones */
+static void prune_slot(struct stats_slot *slot, uint32_t generation)
+{
+	size_t kept = 0;
+	
+	for (size_t i = 0; i < slot->count; i++)
+		if (slot->values[i].generation == generation)
+			slot->values[kept++] = slot->values[i];
+	slot->count = kept;
+}
+
+static int stats_response(struct nl_msg *msg, void *arg)
+{
+	struct qca_stats_poller *poller = arg;
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct nlattr *vendor_data;
+	unsigned int ifindex;
+	
+	if (genlmsg_parse(nlmsg_hdr(msg), 0, tb, NL80211_ATTR_MAX, NULL) < 0 ||
+	    !tb[NL80211_ATTR_IFINDEX] || !tb[NL80211_ATTR_VENDOR_DATA])
+		return NL_SKIP;
+	
+	ifindex = nla_get_u32(tb[NL80211_ATTR_IFINDEX]);
+	vendor_data = tb[NL80211_ATTR_VENDOR_DATA];
+	for (size_t i = 0; i < poller->count; i++) {
+		struct stats_slot *slot = &poller->slots[i];
+		
+		if (slot->ifindex == ifindex) {
+			update_slot(poller, slot, slot->replies++,
+			            nla_data(vendor_data), nla_len(vendor_data));
+			break;
+		}
+	}
+	return NL_OK;
+}
+
+/**
+ * Create a stats poller
+ */
+struct qca_stats_poller *qca_stats_poller_create(const struct qca_stats_poller_config *config)
+{
+	struct qca_stats_poller *poller;
+	
+	if (!config || !config->ifnames || !config->count ||
+	    config->count > QCA_STATS_MAX_INTERFACES || config->jitter_pct > 50)
+		return NULL;
+	
+	poller = calloc(1, sizeof(*poller));
+	if (!poller)
+		return NULL;
+	
+	poller->sink = config->sink;
+	poller->user_data = config->user_data;
+	poller->interval_ms = config->interval_ms;
+	poller->jitter_pct = config->jitter_pct;
+	poller->seed = (unsigned int)time(NULL) ^ (unsigned int)getpid() ^
+	               (unsigned int)(uintptr_t)poller;
+	poller->count = config->count;
+	for (size_t i = 0; i < config->count; i++)
+		snprintf(poller->slots[i].ifname, sizeof(poller->slots[i].ifname), "%s",
+		         config->ifnames[i]);
+	
+	return poller;
+}
+
+/**
+ * Fetch and report the link stats of every interface
+ */
+int qca_stats_poller_poll(struct qca_stats_poller *poller)
+{
+	const char *ifnames[QCA_STATS_MAX_INTERFACES];
+	int errors[QCA_STATS_MAX_INTERFACES];
+	int failed;
+	
+	if (!poller->session) {
+		poller->session = qca_session_open();
+		if (!poller->session)
+			return -1;
+	}
+	
+	/* Interfaces may have come back with another index */
+	for (size_t i = 0; i < poller->count; i++) {
+		poller->slots[i].ifindex = if_nametoindex(poller->slots[i].ifname);
+		poller->slots[i].replies = 0;
+		ifnames[i] = poller->slots[i].ifname;
+	}
+	poller->generation++;
+	
+	failed = qca_session_get_link_stats(poller->session, ifnames, poller->count,
+	                                    stats_response, poller, errors);
+	if (failed < 0) {
+		qca_session_close(poller->session);
+		poller->session = NULL;
+		return (int)poller->count;
+	}
+	
+	for (size_t i = 0; i < poller->count; i++) {
+		if (!errors[i])
+			prune_slot(&poller->slots[i], poller->generation);
+		else if (g_qca_config.verbose)
+			syslog(LOG_INFO, "Link stats of %s failed: %s", ifnames[i],
+			       strerror(-errors[i]));
+	}
+	return failed;
+}
+
+/**
+ * Compare one reply of a sample with the previous sample
+ */
+int qca_stats_poller_update(struct qca_stats_poller *poller, const char *ifname,
+                            unsigned int reply, const void *data, size_t len)
+{
+	for (size_t i = 0; i < poller->count; i++)
+		if (strcmp(poller->slots[i].ifname, ifname) == 0)
+			return update_slot(poller, &poller->slots[i], reply, data, len);
+	return -1;
+}
+
+/**
+ * Forget the samples of every interface
+ */
+void qca_stats_poller_reset(struct qca_stats_poller *poller)
+{
+	for (size_t i = 0; i < poller->count; i++)
+		poller->slots[i].count = 0;
+}
+
+/**
+ * Time until the next poll
+ */
+unsigned int qca_stats_poller_next_ms(struct qca_stats_poller *poller)
+{
+	unsigned int spread = (unsigned int)((uint64_t)poller->interval_ms * poller->jitter_pct / 100);
+	
+	if (!spread)
+		return poller->interval_ms;
+	return poller->interval_ms - spread + (unsigned int)rand_r(&poller->seed) % (2 * spread + 1);
+}
+
+/**
+ * Destroy a stats poller
+ */
+void qca_stats_poller_destroy(struct qca_stats_poller *poller)
+{
+	if (!poller)
+		return;
+	
+	qca_session_close(poller->session);
+	free(poller);
+}
+
+/**
+ * Format a counter key
+ */
+int qca_stats_key_format(uint64_t key, char *buf, size_t len)
+{
+	int depth = (int)(key >> 30 & 3);
+	int n = snprintf(buf, len, "%u:", (unsigned int)(key >> 32 & 0xffff));
+	
+	for (int level = 0; level < depth && n >= 0; level++) {
+		unsigned int type = (unsigned int)(key >> (STATS_KEY_BITS * (QCA_STATS_MAX_DEPTH - 1 - level))) &
+		                    ((1U << STATS_KEY_BITS) - 1);
+		int m = snprintf(buf + ((size_t)n < len ? (size_t)n : len),
+		                 (size_t)n < len ? len - (size_t)n : 0,
+		                 level ? ".%u" : "%u", type);
+		
+		n = m < 0 ? m : n + m;
+	}
+	return n;
+}
@@ -1,151 +1,342 @@
 /* QCA vendor command decoder */
 
 #include "qca_vendor.h"
+#include "name_table.h"
 #include <stddef.h>
+#include <string.h>
+
+/* Names of the vendor subcommands and attributes, without their
+ * QCA_NL80211_VENDOR_SUBCMD_ and QCA_WLAN_VENDOR_ATTR_ prefixes, in the
+ * order of enum qca_nl80211_vendor_subcmds and enum qca_wlan_vendor_attr */
+static const struct name_table_entry vendor_subcmd_entries[] = {
+	{ QCA_NL80211_VENDOR_SUBCMD_UNSPEC,                         "UNSPEC" },
+	{ QCA_NL80211_VENDOR_SUBCMD_TEST,                           "TEST" },
+	{ QCA_NL80211_VENDOR_SUBCMD_ROAMING,                        "ROAMING" },
+	{ QCA_NL80211_VENDOR_SUBCMD_AVOID_FREQUENCY,                "AVOID_FREQUENCY" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DFS_CAPABILITY,                 "DFS_CAPABILITY" },
+	{ QCA_NL80211_VENDOR_SUBCMD_NAN,                            "NAN" },
+	{ QCA_NL80211_VENDOR_SUBCMD_STATS_EXT,                      "STATS_EXT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_LL_STATS_SET,                   "LL_STATS_SET" },
+	{ QCA_NL80211_VENDOR_SUBCMD_LL_STATS_GET,                   "LL_STATS_GET" },
+	{ QCA_NL80211_VENDOR_SUBCMD_LL_STATS_CLR,                   "LL_STATS_CLR" },
+	{ QCA_NL80211_VENDOR_SUBCMD_LL_STATS_RADIO_RESULTS,         "LL_STATS_RADIO_RESULTS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_LL_STATS_IFACE_RESULTS,         "LL_STATS_IFACE_RESULTS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_LL_STATS_PEERS_RESULTS,         "LL_STATS_PEERS_RESULTS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_START,                    "GSCAN_START" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_STOP,                     "GSCAN_STOP" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_GET_VALID_CHANNELS,       "GSCAN_GET_VALID_CHANNELS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_GET_CAPABILITIES,         "GSCAN_GET_CAPABILITIES" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_GET_CACHED_RESULTS,       "GSCAN_GET_CACHED_RESULTS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_SCAN_RESULTS_AVAILABLE,   "GSCAN_SCAN_RESULTS_AVAILABLE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_FULL_SCAN_RESULT,         "GSCAN_FULL_SCAN_RESULT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_SCAN_EVENT,               "GSCAN_SCAN_EVENT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_HOTLIST_AP_FOUND,         "GSCAN_HOTLIST_AP_FOUND" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_SET_BSSID_HOTLIST,        "GSCAN_SET_BSSID_HOTLIST" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_RESET_BSSID_HOTLIST,      "GSCAN_RESET_BSSID_HOTLIST" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_SIGNIFICANT_CHANGE,       "GSCAN_SIGNIFICANT_CHANGE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_SET_SIGNIFICANT_CHANGE,   "GSCAN_SET_SIGNIFICANT_CHANGE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_RESET_SIGNIFICANT_CHANGE, "GSCAN_RESET_SIGNIFICANT_CHANGE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_TDLS_ENABLE,                    "TDLS_ENABLE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_TDLS_DISABLE,                   "TDLS_DISABLE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_TDLS_GET_STATUS,                "TDLS_GET_STATUS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_TDLS_STATE,                     "TDLS_STATE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_SUPPORTED_FEATURES,         "GET_SUPPORTED_FEATURES" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SCANNING_MAC_OUI,               "SCANNING_MAC_OUI" },
+	{ QCA_NL80211_VENDOR_SUBCMD_NO_DFS_FLAG,                    "NO_DFS_FLAG" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_HOTLIST_AP_LOST,          "GSCAN_HOTLIST_AP_LOST" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_CONCURRENCY_MATRIX,         "GET_CONCURRENCY_MATRIX" },
+	{ QCA_NL80211_VENDOR_SUBCMD_KEY_MGMT_SET_KEY,               "KEY_MGMT_SET_KEY" },
+	{ QCA_NL80211_VENDOR_SUBCMD_KEY_MGMT_ROAM_AUTH,             "KEY_MGMT_ROAM_AUTH" },
+	{ QCA_NL80211_VENDOR_SUBCMD_APFIND,                         "APFIND" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DO_ACS,                         "DO_ACS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_FEATURES,                   "GET_FEATURES" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DFS_OFFLOAD_CAC_STARTED,        "DFS_OFFLOAD_CAC_STARTED" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DFS_OFFLOAD_CAC_FINISHED,       "DFS_OFFLOAD_CAC_FINISHED" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DFS_OFFLOAD_CAC_ABORTED,        "DFS_OFFLOAD_CAC_ABORTED" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DFS_OFFLOAD_CAC_NOP_FINISHED,   "DFS_OFFLOAD_CAC_NOP_FINISHED" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DFS_OFFLOAD_RADAR_DETECTED,     "DFS_OFFLOAD_RADAR_DETECTED" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_WIFI_INFO,                  "GET_WIFI_INFO" },
+	{ QCA_NL80211_VENDOR_SUBCMD_WIFI_LOGGER_START,              "WIFI_LOGGER_START" },
+	{ QCA_NL80211_VENDOR_SUBCMD_WIFI_LOGGER_MEMORY_DUMP,        "WIFI_LOGGER_MEMORY_DUMP" },
+	{ QCA_NL80211_VENDOR_SUBCMD_ROAM,                           "ROAM" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_SET_SSID_HOTLIST,         "GSCAN_SET_SSID_HOTLIST" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_RESET_SSID_HOTLIST,       "GSCAN_RESET_SSID_HOTLIST" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_HOTLIST_SSID_FOUND,       "GSCAN_HOTLIST_SSID_FOUND" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GSCAN_HOTLIST_SSID_LOST,        "GSCAN_HOTLIST_SSID_LOST" },
+	{ QCA_NL80211_VENDOR_SUBCMD_PNO_SET_LIST,                   "PNO_SET_LIST" },
+	{ QCA_NL80211_VENDOR_SUBCMD_PNO_SET_PASSPOINT_LIST,         "PNO_SET_PASSPOINT_LIST" },
+	{ QCA_NL80211_VENDOR_SUBCMD_PNO_RESET_PASSPOINT_LIST,       "PNO_RESET_PASSPOINT_LIST" },
+	{ QCA_NL80211_VENDOR_SUBCMD_PNO_NETWORK_FOUND,              "PNO_NETWORK_FOUND" },
+	{ QCA_NL80211_VENDOR_SUBCMD_PNO_PASSPOINT_NETWORK_FOUND,    "PNO_PASSPOINT_NETWORK_FOUND" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SET_WIFI_CONFIGURATION,         "SET_WIFI_CONFIGURATION" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_WIFI_CONFIGURATION,         "GET_WIFI_CONFIGURATION" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_LOGGER_FEATURE_SET,         "GET_LOGGER_FEATURE_SET" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_RING_DATA,                  "GET_RING_DATA" },
+	{ QCA_NL80211_VENDOR_SUBCMD_TDLS_GET_CAPABILITIES,          "TDLS_GET_CAPABILITIES" },
+	{ QCA_NL80211_VENDOR_SUBCMD_OFFLOADED_PACKETS,              "OFFLOADED_PACKETS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_MONITOR_RSSI,                   "MONITOR_RSSI" },
+	{ QCA_NL80211_VENDOR_SUBCMD_NDP,                            "NDP" },
+	{ QCA_NL80211_VENDOR_SUBCMD_ND_OFFLOAD,                     "ND_OFFLOAD" },
+	{ QCA_NL80211_VENDOR_SUBCMD_PACKET_FILTER,                  "PACKET_FILTER" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_BUS_SIZE,                   "GET_BUS_SIZE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_WAKE_REASON_STATS,          "GET_WAKE_REASON_STATS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DATA_OFFLOAD,                   "DATA_OFFLOAD" },
+	{ QCA_NL80211_VENDOR_SUBCMD_OCB_SET_CONFIG,                 "OCB_SET_CONFIG" },
+	{ QCA_NL80211_VENDOR_SUBCMD_OCB_SET_UTC_TIME,               "OCB_SET_UTC_TIME" },
+	{ QCA_NL80211_VENDOR_SUBCMD_OCB_START_TIMING_ADVERT,        "OCB_START_TIMING_ADVERT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_OCB_STOP_TIMING_ADVERT,         "OCB_STOP_TIMING_ADVERT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_OCB_GET_TSF_TIMER,              "OCB_GET_TSF_TIMER" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DCC_GET_STATS,                  "DCC_GET_STATS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DCC_CLEAR_STATS,                "DCC_CLEAR_STATS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DCC_UPDATE_NDL,                 "DCC_UPDATE_NDL" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DCC_STATS_EVENT,                "DCC_STATS_EVENT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_LINK_PROPERTIES,                "LINK_PROPERTIES" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GW_PARAM_CONFIG,                "GW_PARAM_CONFIG" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_PREFERRED_FREQ_LIST,        "GET_PREFERRED_FREQ_LIST" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SET_PROBABLE_OPER_CHANNEL,      "SET_PROBABLE_OPER_CHANNEL" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SETBAND,                        "SETBAND" },
+	{ QCA_NL80211_VENDOR_SUBCMD_TRIGGER_SCAN,                   "TRIGGER_SCAN" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SCAN_DONE,                      "SCAN_DONE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_OTA_TEST,                       "OTA_TEST" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SET_TXPOWER_SCALE,              "SET_TXPOWER_SCALE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SET_TXPOWER_DECR_DB,            "SET_TXPOWER_DECR_DB" },
+	{ QCA_NL80211_VENDOR_SUBCMD_ACS_POLICY,                     "ACS_POLICY" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SET_SAP_CONFIG,                 "SET_SAP_CONFIG" },
+	{ QCA_NL80211_VENDOR_SUBCMD_TSF,                            "TSF" },
+	{ QCA_NL80211_VENDOR_SUBCMD_WISA,                           "WISA" },
+	{ QCA_NL80211_VENDOR_SUBCMD_P2P_LISTEN_OFFLOAD_START,       "P2P_LISTEN_OFFLOAD_START" },
+	{ QCA_NL80211_VENDOR_SUBCMD_P2P_LISTEN_OFFLOAD_STOP,        "P2P_LISTEN_OFFLOAD_STOP" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SAP_CONDITIONAL_CHAN_SWITCH,    "SAP_CONDITIONAL_CHAN_SWITCH" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GPIO_CONFIG_COMMAND,            "GPIO_CONFIG_COMMAND" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_HW_CAPABILITY,              "GET_HW_CAPABILITY" },
+	{ QCA_NL80211_VENDOR_SUBCMD_LL_STATS_EXT,                   "LL_STATS_EXT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_LOC_GET_CAPA,                   "LOC_GET_CAPA" },
+	{ QCA_NL80211_VENDOR_SUBCMD_FTM_START_SESSION,              "FTM_START_SESSION" },
+	{ QCA_NL80211_VENDOR_SUBCMD_FTM_ABORT_SESSION,              "FTM_ABORT_SESSION" },
+	{ QCA_NL80211_VENDOR_SUBCMD_FTM_MEAS_RESULT,                "FTM_MEAS_RESULT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_FTM_SESSION_DONE,               "FTM_SESSION_DONE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_FTM_CFG_RESPONDER,              "FTM_CFG_RESPONDER" },
+	{ QCA_NL80211_VENDOR_SUBCMD_AOA_MEAS,                       "AOA_MEAS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_AOA_ABORT_MEAS,                 "AOA_ABORT_MEAS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_AOA_MEAS_RESULT,                "AOA_MEAS_RESULT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_ENCRYPTION_TEST,                "ENCRYPTION_TEST" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_CHAIN_RSSI,                 "GET_CHAIN_RSSI" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DMG_RF_GET_SECTOR_CFG,          "DMG_RF_GET_SECTOR_CFG" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DMG_RF_SET_SECTOR_CFG,          "DMG_RF_SET_SECTOR_CFG" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DMG_RF_GET_SELECTED_SECTOR,     "DMG_RF_GET_SELECTED_SECTOR" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DMG_RF_SET_SELECTED_SECTOR,     "DMG_RF_SET_SELECTED_SECTOR" },
+	{ QCA_NL80211_VENDOR_SUBCMD_CONFIGURE_TDLS,                 "CONFIGURE_TDLS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_HE_CAPABILITIES,            "GET_HE_CAPABILITIES" },
+	{ QCA_NL80211_VENDOR_SUBCMD_ABORT_SCAN,                     "ABORT_SCAN" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SET_SAR_LIMITS,                 "SET_SAR_LIMITS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_EXTERNAL_ACS,                   "EXTERNAL_ACS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_CHIP_PWRSAVE_FAILURE,           "CHIP_PWRSAVE_FAILURE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_NUD_STATS_SET,                  "NUD_STATS_SET" },
+	{ QCA_NL80211_VENDOR_SUBCMD_NUD_STATS_GET,                  "NUD_STATS_GET" },
+	{ QCA_NL80211_VENDOR_SUBCMD_FETCH_BSS_TRANSITION_STATUS,    "FETCH_BSS_TRANSITION_STATUS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SET_TRACE_LEVEL,                "SET_TRACE_LEVEL" },
+	{ QCA_NL80211_VENDOR_SUBCMD_BRP_SET_ANT_LIMIT,              "BRP_SET_ANT_LIMIT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SPECTRAL_SCAN_START,            "SPECTRAL_SCAN_START" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SPECTRAL_SCAN_STOP,             "SPECTRAL_SCAN_STOP" },
+	{ QCA_NL80211_VENDOR_SUBCMD_ACTIVE_TOS,                     "ACTIVE_TOS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_HANG,                           "HANG" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SPECTRAL_SCAN_GET_CONFIG,       "SPECTRAL_SCAN_GET_CONFIG" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SPECTRAL_SCAN_GET_DIAG_STATS,   "SPECTRAL_SCAN_GET_DIAG_STATS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SPECTRAL_SCAN_GET_CAP_INFO,     "SPECTRAL_SCAN_GET_CAP_INFO" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SPECTRAL_SCAN_GET_STATUS,       "SPECTRAL_SCAN_GET_STATUS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_PEER_FLUSH_PENDING,             "PEER_FLUSH_PENDING" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_RROP_INFO,                  "GET_RROP_INFO" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_SAR_LIMITS,                 "GET_SAR_LIMITS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_WLAN_MAC_INFO,                  "WLAN_MAC_INFO" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SET_QDEPTH_THRESH,              "SET_QDEPTH_THRESH" },
+	{ QCA_NL80211_VENDOR_SUBCMD_THERMAL_CMD,                    "THERMAL_CMD" },
+	{ QCA_NL80211_VENDOR_SUBCMD_THERMAL_EVENT,                  "THERMAL_EVENT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_WIFI_TEST_CONFIGURATION,        "WIFI_TEST_CONFIGURATION" },
+	{ QCA_NL80211_VENDOR_SUBCMD_BSS_FILTER,                     "BSS_FILTER" },
+	{ QCA_NL80211_VENDOR_SUBCMD_NAN_EXT,                        "NAN_EXT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_ROAM_SCAN_EVENT,                "ROAM_SCAN_EVENT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_PEER_CFR_CAPTURE_CFG,           "PEER_CFR_CAPTURE_CFG" },
+	{ QCA_NL80211_VENDOR_SUBCMD_THROUGHPUT_CHANGE_EVENT,        "THROUGHPUT_CHANGE_EVENT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_COEX_CONFIG,                    "COEX_CONFIG" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_SUPPORTED_AKMS,             "GET_SUPPORTED_AKMS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_FW_STATE,                   "GET_FW_STATE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_PEER_STATS_CACHE_FLUSH,         "PEER_STATS_CACHE_FLUSH" },
+	{ QCA_NL80211_VENDOR_SUBCMD_MPTA_HELPER_CONFIG,             "MPTA_HELPER_CONFIG" },
+	{ QCA_NL80211_VENDOR_SUBCMD_BEACON_REPORTING,               "BEACON_REPORTING" },
+	{ QCA_NL80211_VENDOR_SUBCMD_INTEROP_ISSUES_AP,              "INTEROP_ISSUES_AP" },
+	{ QCA_NL80211_VENDOR_SUBCMD_OEM_DATA,                       "OEM_DATA" },
+	{ QCA_NL80211_VENDOR_SUBCMD_AVOID_FREQUENCY_EXT,            "AVOID_FREQUENCY_EXT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_ADD_STA_NODE,                   "ADD_STA_NODE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_BTC_CHAIN_MODE,                 "BTC_CHAIN_MODE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_STA_INFO,                   "GET_STA_INFO" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_SAR_LIMITS_EVENT,           "GET_SAR_LIMITS_EVENT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_UPDATE_STA_INFO,                "UPDATE_STA_INFO" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DRIVER_DISCONNECT_REASON,       "DRIVER_DISCONNECT_REASON" },
+	{ QCA_NL80211_VENDOR_SUBCMD_CONFIG_TSPEC,                   "CONFIG_TSPEC" },
+	{ QCA_NL80211_VENDOR_SUBCMD_CONFIG_TWT,                     "CONFIG_TWT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GETBAND,                        "GETBAND" },
+	{ QCA_NL80211_VENDOR_SUBCMD_MEDIUM_ASSESS,                  "MEDIUM_ASSESS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_UPDATE_SSID,                    "UPDATE_SSID" },
+	{ QCA_NL80211_VENDOR_SUBCMD_WIFI_FW_STATS,                  "WIFI_FW_STATS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_MBSSID_TX_VDEV_STATUS,          "MBSSID_TX_VDEV_STATUS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_CONCURRENT_POLICY,              "CONCURRENT_POLICY" },
+	{ QCA_NL80211_VENDOR_SUBCMD_USABLE_CHANNELS,                "USABLE_CHANNELS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_RADAR_HISTORY,              "GET_RADAR_HISTORY" },
+	{ QCA_NL80211_VENDOR_SUBCMD_MDNS_OFFLOAD,                   "MDNS_OFFLOAD" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SET_MONITOR_MODE,               "SET_MONITOR_MODE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_ROAM_EVENTS,                    "ROAM_EVENTS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_RATEMASK_CONFIG,                "RATEMASK_CONFIG" },
+	{ QCA_NL80211_VENDOR_SUBCMD_MCC_QUOTA,                      "MCC_QUOTA" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_RADIO_COMBINATION_MATRIX,   "GET_RADIO_COMBINATION_MATRIX" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DRIVER_READY,                   "DRIVER_READY" },
+	{ QCA_NL80211_VENDOR_SUBCMD_PASN,                           "PASN" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SECURE_RANGING_CONTEXT,         "SECURE_RANGING_CONTEXT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_COAP_OFFLOAD,                   "COAP_OFFLOAD" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SCS_RULE_CONFIG,                "SCS_RULE_CONFIG" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_SAR_CAPABILITY,             "GET_SAR_CAPABILITY" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SR,                             "SR" },
+	{ QCA_NL80211_VENDOR_SUBCMD_MLO_PEER_PRIM_NETDEV_EVENT,     "MLO_PEER_PRIM_NETDEV_EVENT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_AFC_EVENT,                      "AFC_EVENT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_AFC_RESPONSE,                   "AFC_RESPONSE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DOZED_AP,                       "DOZED_AP" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_MONITOR_MODE,               "GET_MONITOR_MODE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_ROAM_STATS,                     "ROAM_STATS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_MLO_LINK_STATE,                 "MLO_LINK_STATE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_CONNECTED_CHANNEL_STATS,        "CONNECTED_CHANNEL_STATS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_TID_TO_LINK_MAP,                "TID_TO_LINK_MAP" },
+	{ QCA_NL80211_VENDOR_SUBCMD_LINK_RECONFIG,                  "LINK_RECONFIG" },
+	{ QCA_NL80211_VENDOR_SUBCMD_TDLS_DISC_RSP_EXT,              "TDLS_DISC_RSP_EXT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_AUDIO_TRANSPORT_SWITCH,         "AUDIO_TRANSPORT_SWITCH" },
+	{ QCA_NL80211_VENDOR_SUBCMD_TX_LATENCY,                     "TX_LATENCY" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SDWF_PHY_OPS,                   "SDWF_PHY_OPS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SDWF_DEV_OPS,                   "SDWF_DEV_OPS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_REGULATORY_TPC_INFO,            "REGULATORY_TPC_INFO" },
+	{ QCA_NL80211_VENDOR_SUBCMD_FW_PAGE_FAULT_REPORT,           "FW_PAGE_FAULT_REPORT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_FLOW_POLICY,                    "FLOW_POLICY" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DISASSOC_PEER,                  "DISASSOC_PEER" },
+	{ QCA_NL80211_VENDOR_SUBCMD_ADJUST_TX_POWER,                "ADJUST_TX_POWER" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SPECTRAL_SCAN_COMPLETE,         "SPECTRAL_SCAN_COMPLETE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_ASYNC_GET_STATION,              "ASYNC_GET_STATION" },
+	{ QCA_NL80211_VENDOR_SUBCMD_AP_SUSPEND,                     "AP_SUSPEND" },
+	{ QCA_NL80211_VENDOR_SUBCMD_FLOW_STATS,                     "FLOW_STATS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_FLOW_CLASSIFY_RESULT,           "FLOW_CLASSIFY_RESULT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_ASYNC_STATS_POLICY,             "ASYNC_STATS_POLICY" },
+	{ QCA_NL80211_VENDOR_SUBCMD_CLASSIFIED_FLOW_REPORT,         "CLASSIFIED_FLOW_REPORT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_USD,                            "USD" },
+	{ QCA_NL80211_VENDOR_SUBCMD_CONNECT_EXT,                    "CONNECT_EXT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_SET_P2P_MODE,                   "SET_P2P_MODE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_CHAN_USAGE_REQ,                 "CHAN_USAGE_REQ" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_FW_SCAN_REPORT,             "GET_FW_SCAN_REPORT" },
+	{ QCA_NL80211_VENDOR_SUBCMD_IDLE_SHUTDOWN,                  "IDLE_SHUTDOWN" },
+	{ QCA_NL80211_VENDOR_SUBCMD_PRI_LINK_MIGRATE,               "PRI_LINK_MIGRATE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_PERIODIC_PROBE_RSP_CFG,         "PERIODIC_PROBE_RSP_CFG" },
+	{ QCA_NL80211_VENDOR_SUBCMD_CLASSIFIED_FLOW_STATUS,         "CLASSIFIED_FLOW_STATUS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_RX_MCS_MAP_CONFIG,              "RX_MCS_MAP_CONFIG" },
+	{ QCA_NL80211_VENDOR_SUBCMD_IQ_DATA_INFERENCE,              "IQ_DATA_INFERENCE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_P2P_SET_NOA,                    "P2P_SET_NOA" },
+	{ QCA_NL80211_VENDOR_SUBCMD_WLAN_TELEMETRY_WIPHY,           "WLAN_TELEMETRY_WIPHY" },
+	{ QCA_NL80211_VENDOR_SUBCMD_WLAN_TELEMETRY_WDEV,            "WLAN_TELEMETRY_WDEV" },
+	{ QCA_NL80211_VENDOR_SUBCMD_LINK_STATE_CHANGE,              "LINK_STATE_CHANGE" },
+	{ QCA_NL80211_VENDOR_SUBCMD_DAR,                            "DAR" },
+	{ QCA_NL80211_VENDOR_SUBCMD_FEATURE_CONFIG,                 "FEATURE_CONFIG" },
+	{ QCA_NL80211_VENDOR_SUBCMD_GET_COEX_STATS,                 "GET_COEX_STATS" },
+	{ QCA_NL80211_VENDOR_SUBCMD_ATF_OFFLOAD_OPS,                "ATF_OFFLOAD_OPS" },
+};
+
+static const struct name_table_entry vendor_attr_entries[] = {
+	{ QCA_WLAN_VENDOR_ATTR_INVALID,                              "INVALID" },
+	{ QCA_WLAN_VENDOR_ATTR_DFS,                                  "DFS" },
+	{ QCA_WLAN_VENDOR_ATTR_NAN,                                  "NAN" },
+	{ QCA_WLAN_VENDOR_ATTR_STATS_EXT,                            "STATS_EXT" },
+	{ QCA_WLAN_VENDOR_ATTR_IFINDEX,                              "IFINDEX" },
+	{ QCA_WLAN_VENDOR_ATTR_ROAMING_POLICY,                       "ROAMING_POLICY" },
+	{ QCA_WLAN_VENDOR_ATTR_MAC_ADDR,                             "MAC_ADDR" },
+	{ QCA_WLAN_VENDOR_ATTR_FEATURE_FLAGS,                        "FEATURE_FLAGS" },
+	{ QCA_WLAN_VENDOR_ATTR_TEST,                                 "TEST" },
+	{ QCA_WLAN_VENDOR_ATTR_CONCURRENCY_CAPA,                     "CONCURRENCY_CAPA" },
+	{ QCA_WLAN_VENDOR_ATTR_MAX_CONCURRENT_CHANNELS_2_4_BAND,     "MAX_CONCURRENT_CHANNELS_2_4_BAND" },
+	{ QCA_WLAN_VENDOR_ATTR_MAX_CONCURRENT_CHANNELS_5_0_BAND,     "MAX_CONCURRENT_CHANNELS_5_0_BAND" },
+	{ QCA_WLAN_VENDOR_ATTR_SETBAND_VALUE,                        "SETBAND_VALUE" },
+	{ QCA_WLAN_VENDOR_ATTR_PAD,                                  "PAD" },
+	{ QCA_WLAN_VENDOR_ATTR_FTM_SESSION_COOKIE,                   "FTM_SESSION_COOKIE" },
+	{ QCA_WLAN_VENDOR_ATTR_LOC_CAPA,                             "LOC_CAPA" },
+	{ QCA_WLAN_VENDOR_ATTR_FTM_MEAS_PEERS,                       "FTM_MEAS_PEERS" },
+	{ QCA_WLAN_VENDOR_ATTR_FTM_MEAS_PEER_RESULTS,                "FTM_MEAS_PEER_RESULTS" },
+	{ QCA_WLAN_VENDOR_ATTR_FTM_RESPONDER_ENABLE,                 "FTM_RESPONDER_ENABLE" },
+	{ QCA_WLAN_VENDOR_ATTR_FTM_LCI,                              "FTM_LCI" },
+	{ QCA_WLAN_VENDOR_ATTR_FTM_LCR,                              "FTM_LCR" },
+	{ QCA_WLAN_VENDOR_ATTR_LOC_SESSION_STATUS,                   "LOC_SESSION_STATUS" },
+	{ QCA_WLAN_VENDOR_ATTR_FTM_INITIAL_TOKEN,                    "FTM_INITIAL_TOKEN" },
+	{ QCA_WLAN_VENDOR_ATTR_AOA_TYPE,                             "AOA_TYPE" },
+	{ QCA_WLAN_VENDOR_ATTR_LOC_ANTENNA_ARRAY_MASK,               "LOC_ANTENNA_ARRAY_MASK" },
+	{ QCA_WLAN_VENDOR_ATTR_AOA_MEAS_RESULT,                      "AOA_MEAS_RESULT" },
+	{ QCA_WLAN_VENDOR_ATTR_CHAIN_INDEX,                          "CHAIN_INDEX" },
+	{ QCA_WLAN_VENDOR_ATTR_CHAIN_RSSI,                           "CHAIN_RSSI" },
+	{ QCA_WLAN_VENDOR_ATTR_FREQ,                                 "FREQ" },
+	{ QCA_WLAN_VENDOR_ATTR_TSF,                                  "TSF" },
+	{ QCA_WLAN_VENDOR_ATTR_DMG_RF_SECTOR_INDEX,                  "DMG_RF_SECTOR_INDEX" },
+	{ QCA_WLAN_VENDOR_ATTR_DMG_RF_SECTOR_TYPE,                   "DMG_RF_SECTOR_TYPE" },
+	{ QCA_WLAN_VENDOR_ATTR_DMG_RF_MODULE_MASK,                   "DMG_RF_MODULE_MASK" },
+	{ QCA_WLAN_VENDOR_ATTR_DMG_RF_SECTOR_CFG,                    "DMG_RF_SECTOR_CFG" },
+	{ QCA_WLAN_VENDOR_ATTR_RX_AGGREGATION_STATS_HOLES_NUM,       "RX_AGGREGATION_STATS_HOLES_NUM" },
+	{ QCA_WLAN_VENDOR_ATTR_RX_AGGREGATION_STATS_HOLES_INFO,      "RX_AGGREGATION_STATS_HOLES_INFO" },
+	{ QCA_WLAN_VENDOR_ATTR_BTM_MBO_TRANSITION_REASON,            "BTM_MBO_TRANSITION_REASON" },
+	{ QCA_WLAN_VENDOR_ATTR_BTM_CANDIDATE_INFO,                   "BTM_CANDIDATE_INFO" },
+	{ QCA_WLAN_VENDOR_ATTR_BRP_ANT_LIMIT_MODE,                   "BRP_ANT_LIMIT_MODE" },
+	{ QCA_WLAN_VENDOR_ATTR_BRP_ANT_NUM_LIMIT,                    "BRP_ANT_NUM_LIMIT" },
+	{ QCA_WLAN_VENDOR_ATTR_ANTENNA_INFO,                         "ANTENNA_INFO" },
+	{ QCA_WLAN_VENDOR_ATTR_CHAIN_EVM,                            "CHAIN_EVM" },
+	{ QCA_WLAN_VENDOR_ATTR_FW_STATE,                             "FW_STATE" },
+	{ QCA_WLAN_VENDOR_ATTR_SETBAND_MASK,                         "SETBAND_MASK" },
+	{ QCA_WLAN_VENDOR_ATTR_MLO_CAPABILITY_MAX_ASSOCIATION_COUNT, "MLO_CAPABILITY_MAX_ASSOCIATION_COUNT" },
+	{ QCA_WLAN_VENDOR_ATTR_MLO_CAPABILITY_MAX_STR_LINK_COUNT,    "MLO_CAPABILITY_MAX_STR_LINK_COUNT" },
+	{ QCA_WLAN_VENDOR_ATTR_ANT_SWITCH_COUNT,                     "ANT_SWITCH_COUNT" },
+	{ QCA_WLAN_VENDOR_ATTR_ANT_DURATION,                         "ANT_DURATION" },
+	{ QCA_WLAN_VENDOR_ATTR_ANT_RSSI,                             "ANT_RSSI" },
+};
+
+static struct name_table vendor_subcmds = NAME_TABLE_INIT(vendor_subcmd_entries);
+static struct name_table vendor_attrs = NAME_TABLE_INIT(vendor_attr_entries);
+
+/* Look up a name with or without its prefix */
+static int find_name(struct name_table *table, const char *prefix,
+                     const char *name, unsigned int *id)
+{
+	size_t prefix_len = strlen(prefix);
+	uint32_t value;
+	
+	if (!name || !id)
+		return -1;
+	
+	if (strncmp(name, prefix, prefix_len) == 0)
+		name += prefix_len;
+	if (!name_table_find(table, name, strlen(name), &value))
+		return -1;
+	
+	*id = value;
+	return 0;
+}
 
 /* Convert QCA vendor subcmd to string */
 const char *qca_vendor_subcmd_to_string(unsigned int subcmd)
 {
-	switch (subcmd) {
-	case QCA_NL80211_VENDOR_SUBCMD_UNSPEC:
-		return "UNSPEC";
-	case QCA_NL80211_VENDOR_SUBCMD_TEST:
-		return "TEST";
-	case QCA_NL80211_VENDOR_SUBCMD_ROAMING:
-		return "ROAMING";
-	case QCA_NL80211_VENDOR_SUBCMD_AVOID_FREQUENCY:
-		return "AVOID_FREQUENCY";
-	case QCA_NL80211_VENDOR_SUBCMD_DFS_CAPABILITY:
-		return "DFS_CAPABILITY";
-	case QCA_NL80211_VENDOR_SUBCMD_NAN:
-		return "NAN";
-	case QCA_NL80211_VENDOR_SUBCMD_STATS_EXT:
-		return "STATS_EXT";
-	case QCA_NL80211_VENDOR_SUBCMD_LL_STATS_SET:
-		return "LL_STATS_SET";
-	case QCA_NL80211_VENDOR_SUBCMD_LL_STATS_GET:
-		return "LL_STATS_GET";
-	case QCA_NL80211_VENDOR_SUBCMD_LL_STATS_CLR:
-		return "LL_STATS_CLR";
-	case QCA_NL80211_VENDOR_SUBCMD_GSCAN_START:
-		return "GSCAN_START";
-	case QCA_NL80211_VENDOR_SUBCMD_GSCAN_STOP:
-		return "GSCAN_STOP";
-	case QCA_NL80211_VENDOR_SUBCMD_GSCAN_GET_CAPABILITIES:
-		return "GSCAN_GET_CAPABILITIES";
-	case QCA_NL80211_VENDOR_SUBCMD_ROAM:
-		return "ROAM";
-	case QCA_NL80211_VENDOR_SUBCMD_SETBAND:
-		return "SETBAND";
-	case QCA_NL80211_VENDOR_SUBCMD_TRIGGER_SCAN:
-		return "TRIGGER_SCAN";
-	case QCA_NL80211_VENDOR_SUBCMD_SCAN_DONE:
-		return "SCAN_DONE";
-	case QCA_NL80211_VENDOR_SUBCMD_GET_FEATURES:
-		return "GET_FEATURES";
-	case QCA_NL80211_VENDOR_SUBCMD_GET_WIFI_INFO:
-		return "GET_WIFI_INFO";
-	case QCA_NL80211_VENDOR_SUBCMD_DO_ACS:
-		return "DO_ACS";
-	case QCA_NL80211_VENDOR_SUBCMD_SET_SAP_CONFIG:
-		return "SET_SAP_CONFIG";
-	case QCA_NL80211_VENDOR_SUBCMD_TSF:
-		return "TSF";
-	case QCA_NL80211_VENDOR_SUBCMD_GET_HW_CAPABILITY:
-		return "GET_HW_CAPABILITY";
-	case QCA_NL80211_VENDOR_SUBCMD_LL_STATS_EXT:
-		return "LL_STATS_EXT";
-	case QCA_NL80211_VENDOR_SUBCMD_LOC_GET_CAPA:
-		return "LOC_GET_CAPA";
-	case QCA_NL80211_VENDOR_SUBCMD_FTM_START_SESSION:
-		return "FTM_START_SESSION";
-	case QCA_NL80211_VENDOR_SUBCMD_FTM_ABORT_SESSION:
-		return "FTM_ABORT_SESSION";
-	case QCA_NL80211_VENDOR_SUBCMD_GET_CHAIN_RSSI:
-		return "GET_CHAIN_RSSI";
-	case QCA_NL80211_VENDOR_SUBCMD_CONFIGURE_TDLS:
-		return "CONFIGURE_TDLS";
-	case QCA_NL80211_VENDOR_SUBCMD_GET_HE_CAPABILITIES:
-		return "GET_HE_CAPABILITIES";
-	case QCA_NL80211_VENDOR_SUBCMD_ABORT_SCAN:
-		return "ABORT_SCAN";
-	case QCA_NL80211_VENDOR_SUBCMD_SET_SAR_LIMITS:
-		return "SET_SAR_LIMITS";
-	case QCA_NL80211_VENDOR_SUBCMD_EXTERNAL_ACS:
-		return "EXTERNAL_ACS";
-	case QCA_NL80211_VENDOR_SUBCMD_CHIP_PWRSAVE_FAILURE:
-		return "CHIP_PWRSAVE_FAILURE";
-	case QCA_NL80211_VENDOR_SUBCMD_NUD_STATS_SET:
-		return "NUD_STATS_SET";
-	case QCA_NL80211_VENDOR_SUBCMD_NUD_STATS_GET:
-		return "NUD_STATS_GET";
-	case QCA_NL80211_VENDOR_SUBCMD_SPECTRAL_SCAN_START:
-		return "SPECTRAL_SCAN_START";
-	case QCA_NL80211_VENDOR_SUBCMD_SPECTRAL_SCAN_STOP:
-		return "SPECTRAL_SCAN_STOP";
-	/* case QCA_NL80211_VENDOR_SUBCMD_ACTIVE_TWT:
-		return "ACTIVE_TWT"; */
-	case QCA_NL80211_VENDOR_SUBCMD_HANG:
-		return "HANG";
-	case QCA_NL80211_VENDOR_SUBCMD_GET_SAR_LIMITS:
-		return "GET_SAR_LIMITS";
-	case QCA_NL80211_VENDOR_SUBCMD_WLAN_MAC_INFO:
-		return "WLAN_MAC_INFO";
-	case QCA_NL80211_VENDOR_SUBCMD_THERMAL_CMD:
-		return "THERMAL_CMD";
-	case QCA_NL80211_VENDOR_SUBCMD_THERMAL_EVENT:
-		return "THERMAL_EVENT";
-	case QCA_NL80211_VENDOR_SUBCMD_WIFI_TEST_CONFIGURATION:
-		return "WIFI_TEST_CONFIGURATION";
-	case QCA_NL80211_VENDOR_SUBCMD_NAN_EXT:
-		return "NAN_EXT";
-	case QCA_NL80211_VENDOR_SUBCMD_PEER_CFR_CAPTURE_CFG:
-		return "PEER_CFR_CAPTURE_CFG";
-	case QCA_NL80211_VENDOR_SUBCMD_COEX_CONFIG:
-		return "COEX_CONFIG";
-	case QCA_NL80211_VENDOR_SUBCMD_GET_SUPPORTED_AKMS:
-		return "GET_SUPPORTED_AKMS";
-	case QCA_NL80211_VENDOR_SUBCMD_GET_FW_STATE:
-		return "GET_FW_STATE";
-	case QCA_NL80211_VENDOR_SUBCMD_BEACON_REPORTING:
-		return "BEACON_REPORTING";
-	case QCA_NL80211_VENDOR_SUBCMD_OEM_DATA:
-		return "OEM_DATA";
-	case QCA_NL80211_VENDOR_SUBCMD_AVOID_FREQUENCY_EXT:
-		return "AVOID_FREQUENCY_EXT";
-	case QCA_NL80211_VENDOR_SUBCMD_ADD_STA_NODE:
-		return "ADD_STA_NODE";
-	case QCA_NL80211_VENDOR_SUBCMD_BTC_CHAIN_MODE:
-		return "BTC_CHAIN_MODE";
-	case QCA_NL80211_VENDOR_SUBCMD_GET_STA_INFO:
-		return "GET_STA_INFO";
-	case QCA_NL80211_VENDOR_SUBCMD_CONFIG_TSPEC:
-		return "CONFIG_TSPEC";
-	case QCA_NL80211_VENDOR_SUBCMD_CONFIG_TWT:
-		return "CONFIG_TWT";
-	case QCA_NL80211_VENDOR_SUBCMD_GETBAND:
-		return "GETBAND";
-	case QCA_NL80211_VENDOR_SUBCMD_MEDIUM_ASSESS:
-		return "MEDIUM_ASSESS";
-	case QCA_NL80211_VENDOR_SUBCMD_UPDATE_SSID:
-		return "UPDATE_SSID";
-	case QCA_NL80211_VENDOR_SUBCMD_WIFI_FW_STATS:
-		return "WIFI_FW_STATS";
-	case QCA_NL80211_VENDOR_SUBCMD_USABLE_CHANNELS:
-		return "USABLE_CHANNELS";
-	case QCA_NL80211_VENDOR_SUBCMD_GET_RADAR_HISTORY:
-		return "GET_RADAR_HISTORY";
-	case QCA_NL80211_VENDOR_SUBCMD_MDNS_OFFLOAD:
-		return "MDNS_OFFLOAD";
-	case QCA_NL80211_VENDOR_SUBCMD_SET_MONITOR_MODE:
-		return "SET_MONITOR_MODE";
-	case QCA_NL80211_VENDOR_SUBCMD_ROAM_EVENTS:
-		return "ROAM_EVENTS";
-	case QCA_NL80211_VENDOR_SUBCMD_MCC_QUOTA:
-		return "MCC_QUOTA";
-	case QCA_NL80211_VENDOR_SUBCMD_DRIVER_READY:
-		return "DRIVER_READY";
-	default:
-		return "UNKNOWN";
-	}
+	return name_table_name(&vendor_subcmds, subcmd);
+}
+
+/* Convert QCA vendor subcmd name to its ID */
+int qca_vendor_subcmd_from_string(const char *name, unsigned int *subcmd)
+{
+	return find_name(&vendor_subcmds, "QCA_NL80211_VENDOR_SUBCMD_", name, subcmd);
+}
+
+/* Convert QCA vendor attribute to string */
+const char *qca_vendor_attr_to_string(unsigned int attr)
+{
+	return name_table_name(&vendor_attrs, attr);
+}
+
+/* Convert QCA vendor attribute name to its ID */
+int qca_vendor_attr_from_string(const char *name, unsigned int *attr)
+{
+	return find_name(&vendor_attrs, "QCA_WLAN_VENDOR_ATTR_", name, attr);
 }
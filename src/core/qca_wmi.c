@@ -2,239 +2,277 @@
 
 #include "qca_wmi.h"
 #include "wmi_error.h"
+#include "name_table.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <ctype.h>
 #include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
-/* Global error statistics for WMI parsing */
+/* Global error statistics for WMI parsing, lines are parsed on any
+ * number of threads */
 static struct wmi_error_stats g_wmi_parse_stats = {0};
+static _Atomic uint64_t g_wmi_parse_operations;
+static pthread_mutex_t g_wmi_parse_lock = PTHREAD_MUTEX_INITIALIZER;
 
-/* Convert WMI command ID to string */
-const char *wmi_cmd_to_string(unsigned int cmd_id)
+static void record_parse_error(int error_code, const char *context)
 {
-	switch (cmd_id) {
+	pthread_mutex_lock(&g_wmi_parse_lock);
+	wmi_error_stats_record(&g_wmi_parse_stats, error_code, context);
+	pthread_mutex_unlock(&g_wmi_parse_lock);
+}
+
+/* Names of the WMI commands, without their WMI_ prefix and _CMDID suffix */
+static const struct name_table_entry wmi_cmd_entries[] = {
 	/* Scan commands */
-	case WMI_START_SCAN_CMDID: return "START_SCAN";
-	case WMI_STOP_SCAN_CMDID: return "STOP_SCAN";
-	
-	/* PDEV commands */
-	case WMI_PDEV_SET_REGDOMAIN_CMDID: return "PDEV_SET_REGDOMAIN";
-	case WMI_PDEV_SET_CHANNEL_CMDID: return "PDEV_SET_CHANNEL";
-	case WMI_PDEV_SET_PARAM_CMDID: return "PDEV_SET_PARAM";
-	case WMI_PDEV_PKTLOG_ENABLE_CMDID: return "PDEV_PKTLOG_ENABLE";
-	case WMI_PDEV_PKTLOG_DISABLE_CMDID: return "PDEV_PKTLOG_DISABLE";
-	case WMI_PDEV_SET_WMM_PARAMS_CMDID: return "PDEV_SET_WMM_PARAMS";
-	case WMI_PDEV_SET_HT_CAP_IE_CMDID: return "PDEV_SET_HT_CAP_IE";
-	case WMI_PDEV_SET_VHT_CAP_IE_CMDID: return "PDEV_SET_VHT_CAP_IE";
-	case WMI_PDEV_SET_DSCP_TID_MAP_CMDID: return "PDEV_SET_DSCP_TID_MAP";
-	case WMI_PDEV_SET_QUIET_MODE_CMDID: return "PDEV_SET_QUIET_MODE";
-	case WMI_PDEV_GREEN_AP_PS_ENABLE_CMDID: return "PDEV_GREEN_AP_PS_ENABLE";
-	case WMI_PDEV_GET_TPC_CONFIG_CMDID: return "PDEV_GET_TPC_CONFIG";
-	case WMI_PDEV_SET_BASE_MACADDR_CMDID: return "PDEV_SET_BASE_MACADDR";
-	
-	/* VDEV commands */
-	case WMI_VDEV_CREATE_CMDID: return "VDEV_CREATE";
-	case WMI_VDEV_DELETE_CMDID: return "VDEV_DELETE";
-	case WMI_VDEV_START_REQUEST_CMDID: return "VDEV_START_REQUEST";
-	case WMI_VDEV_RESTART_REQUEST_CMDID: return "VDEV_RESTART_REQUEST";
-	case WMI_VDEV_UP_CMDID: return "VDEV_UP";
-	case WMI_VDEV_STOP_CMDID: return "VDEV_STOP";
-	case WMI_VDEV_DOWN_CMDID: return "VDEV_DOWN";
-	case WMI_VDEV_SET_PARAM_CMDID: return "VDEV_SET_PARAM";
-	case WMI_VDEV_INSTALL_KEY_CMDID: return "VDEV_INSTALL_KEY";
+	{ WMI_START_SCAN_CMDID,                     "START_SCAN" },
+	{ WMI_STOP_SCAN_CMDID,                      "STOP_SCAN" },
+	
+	/* PDEV (Physical Device) commands */
+	{ WMI_PDEV_SET_REGDOMAIN_CMDID,             "PDEV_SET_REGDOMAIN" },
+	{ WMI_PDEV_SET_CHANNEL_CMDID,               "PDEV_SET_CHANNEL" },
+	{ WMI_PDEV_SET_PARAM_CMDID,                 "PDEV_SET_PARAM" },
+	{ WMI_PDEV_PKTLOG_ENABLE_CMDID,             "PDEV_PKTLOG_ENABLE" },
+	{ WMI_PDEV_PKTLOG_DISABLE_CMDID,            "PDEV_PKTLOG_DISABLE" },
+	{ WMI_PDEV_SET_WMM_PARAMS_CMDID,            "PDEV_SET_WMM_PARAMS" },
+	{ WMI_PDEV_SET_HT_CAP_IE_CMDID,             "PDEV_SET_HT_CAP_IE" },
+	{ WMI_PDEV_SET_VHT_CAP_IE_CMDID,            "PDEV_SET_VHT_CAP_IE" },
+	{ WMI_PDEV_SET_DSCP_TID_MAP_CMDID,          "PDEV_SET_DSCP_TID_MAP" },
+	{ WMI_PDEV_SET_QUIET_MODE_CMDID,            "PDEV_SET_QUIET_MODE" },
+	{ WMI_PDEV_GREEN_AP_PS_ENABLE_CMDID,        "PDEV_GREEN_AP_PS_ENABLE" },
+	{ WMI_PDEV_GET_TPC_CONFIG_CMDID,            "PDEV_GET_TPC_CONFIG" },
+	{ WMI_PDEV_SET_BASE_MACADDR_CMDID,          "PDEV_SET_BASE_MACADDR" },
+	
+	/* VDEV (Virtual Device) commands */
+	{ WMI_VDEV_CREATE_CMDID,                    "VDEV_CREATE" },
+	{ WMI_VDEV_DELETE_CMDID,                    "VDEV_DELETE" },
+	{ WMI_VDEV_START_REQUEST_CMDID,             "VDEV_START_REQUEST" },
+	{ WMI_VDEV_RESTART_REQUEST_CMDID,           "VDEV_RESTART_REQUEST" },
+	{ WMI_VDEV_UP_CMDID,                        "VDEV_UP" },
+	{ WMI_VDEV_STOP_CMDID,                      "VDEV_STOP" },
+	{ WMI_VDEV_DOWN_CMDID,                      "VDEV_DOWN" },
+	{ WMI_VDEV_SET_PARAM_CMDID,                 "VDEV_SET_PARAM" },
+	{ WMI_VDEV_INSTALL_KEY_CMDID,               "VDEV_INSTALL_KEY" },
 	
 	/* Peer commands */
-	case WMI_PEER_CREATE_CMDID: return "PEER_CREATE";
-	case WMI_PEER_DELETE_CMDID: return "PEER_DELETE";
-	case WMI_PEER_FLUSH_TIDS_CMDID: return "PEER_FLUSH_TIDS";
-	case WMI_PEER_SET_PARAM_CMDID: return "PEER_SET_PARAM";
-	case WMI_PEER_ASSOC_CMDID: return "PEER_ASSOC";
-	case WMI_PEER_ADD_WDS_ENTRY_CMDID: return "PEER_ADD_WDS_ENTRY";
-	case WMI_PEER_REMOVE_WDS_ENTRY_CMDID: return "PEER_REMOVE_WDS_ENTRY";
-	case WMI_PEER_MCAST_GROUP_CMDID: return "PEER_MCAST_GROUP";
+	{ WMI_PEER_CREATE_CMDID,                    "PEER_CREATE" },
+	{ WMI_PEER_DELETE_CMDID,                    "PEER_DELETE" },
+	{ WMI_PEER_FLUSH_TIDS_CMDID,                "PEER_FLUSH_TIDS" },
+	{ WMI_PEER_SET_PARAM_CMDID,                 "PEER_SET_PARAM" },
+	{ WMI_PEER_ASSOC_CMDID,                     "PEER_ASSOC" },
+	{ WMI_PEER_ADD_WDS_ENTRY_CMDID,             "PEER_ADD_WDS_ENTRY" },
+	{ WMI_PEER_REMOVE_WDS_ENTRY_CMDID,          "PEER_REMOVE_WDS_ENTRY" },
+	{ WMI_PEER_MCAST_GROUP_CMDID,               "PEER_MCAST_GROUP" },
 	
 	/* Beacon/Management commands */
-	case WMI_BCN_TX_CMDID: return "BCN_TX";
-	case WMI_PDEV_SEND_BCN_CMDID: return "PDEV_SEND_BCN";
-	case WMI_BCN_TMPL_CMDID: return "BCN_TMPL";
-	case WMI_BCN_FILTER_RX_CMDID: return "BCN_FILTER_RX";
-	case WMI_PRB_REQ_FILTER_RX_CMDID: return "PRB_REQ_FILTER_RX";
-	case WMI_MGMT_TX_CMDID: return "MGMT_TX";
-	case WMI_PRB_TMPL_CMDID: return "PRB_TMPL";
+	{ WMI_BCN_TX_CMDID,                         "BCN_TX" },
+	{ WMI_PDEV_SEND_BCN_CMDID,                  "PDEV_SEND_BCN" },
+	{ WMI_BCN_TMPL_CMDID,                       "BCN_TMPL" },
+	{ WMI_BCN_FILTER_RX_CMDID,                  "BCN_FILTER_RX" },
+	{ WMI_PRB_REQ_FILTER_RX_CMDID,              "PRB_REQ_FILTER_RX" },
+	{ WMI_MGMT_TX_CMDID,                        "MGMT_TX" },
+	{ WMI_PRB_TMPL_CMDID,                       "PRB_TMPL" },
 	
 	/* Statistics commands */
-	case WMI_REQUEST_STATS_CMDID: return "REQUEST_STATS";
-	case WMI_REQUEST_LINK_STATS_CMDID: return "REQUEST_LINK_STATS";
-	case WMI_REQUEST_RCPI_CMDID: return "REQUEST_RCPI";
-	case WMI_VDEV_SPECTRAL_SCAN_CONFIGURE_CMDID: return "VDEV_SPECTRAL_SCAN_CONFIGURE";
-	case WMI_VDEV_SPECTRAL_SCAN_ENABLE_CMDID: return "VDEV_SPECTRAL_SCAN_ENABLE";
+	{ WMI_REQUEST_STATS_CMDID,                  "REQUEST_STATS" },
+	{ WMI_REQUEST_LINK_STATS_CMDID,             "REQUEST_LINK_STATS" },
+	{ WMI_REQUEST_RCPI_CMDID,                   "REQUEST_RCPI" },
+	{ WMI_VDEV_SPECTRAL_SCAN_CONFIGURE_CMDID,   "VDEV_SPECTRAL_SCAN_CONFIGURE" },
+	{ WMI_VDEV_SPECTRAL_SCAN_ENABLE_CMDID,      "VDEV_SPECTRAL_SCAN_ENABLE" },
 	
 	/* Power save commands */
-	case WMI_STA_POWERSAVE_MODE_CMDID: return "STA_POWERSAVE_MODE";
-	case WMI_STA_POWERSAVE_PARAM_CMDID: return "STA_POWERSAVE_PARAM";
-	case WMI_STA_MIMO_PS_MODE_CMDID: return "STA_MIMO_PS_MODE";
+	{ WMI_STA_POWERSAVE_MODE_CMDID,             "STA_POWERSAVE_MODE" },
+	{ WMI_STA_POWERSAVE_PARAM_CMDID,            "STA_POWERSAVE_PARAM" },
+	{ WMI_STA_MIMO_PS_MODE_CMDID,               "STA_MIMO_PS_MODE" },
 	
 	/* P2P commands */
-	case WMI_P2P_GO_SET_BEACON_IE: return "P2P_GO_SET_BEACON_IE";
-	case WMI_P2P_GO_SET_PROBE_RESP_IE: return "P2P_GO_SET_PROBE_RESP_IE";
-	case WMI_P2P_SET_VENDOR_IE_DATA_CMDID: return "P2P_SET_VENDOR_IE_DATA";
+	{ WMI_P2P_GO_SET_BEACON_IE,                 "P2P_GO_SET_BEACON_IE" },
+	{ WMI_P2P_GO_SET_PROBE_RESP_IE,             "P2P_GO_SET_PROBE_RESP_IE" },
+	{ WMI_P2P_SET_VENDOR_IE_DATA_CMDID,         "P2P_SET_VENDOR_IE_DATA" },
 	
 	/* AP commands */
-	case WMI_AP_PS_PEER_PARAM_CMDID: return "AP_PS_PEER_PARAM";
-	case WMI_AP_PS_PEER_UAPSD_COEX_CMDID: return "AP_PS_PEER_UAPSD_COEX";
+	{ WMI_AP_PS_PEER_PARAM_CMDID,               "AP_PS_PEER_PARAM" },
+	{ WMI_AP_PS_PEER_UAPSD_COEX_CMDID,          "AP_PS_PEER_UAPSD_COEX" },
 	
 	/* Roaming commands */
-	case WMI_ROAM_SCAN_MODE: return "ROAM_SCAN_MODE";
-	case WMI_ROAM_SCAN_RSSI_THRESHOLD: return "ROAM_SCAN_RSSI_THRESHOLD";
-	case WMI_ROAM_SCAN_PERIOD: return "ROAM_SCAN_PERIOD";
-	case WMI_ROAM_SCAN_RSSI_CHANGE_THRESHOLD: return "ROAM_SCAN_RSSI_CHANGE_THRESHOLD";
-	case WMI_ROAM_AP_PROFILE: return "ROAM_AP_PROFILE";
+	{ WMI_ROAM_SCAN_MODE,                       "ROAM_SCAN_MODE" },
+	{ WMI_ROAM_SCAN_RSSI_THRESHOLD,             "ROAM_SCAN_RSSI_THRESHOLD" },
+	{ WMI_ROAM_SCAN_PERIOD,                     "ROAM_SCAN_PERIOD" },
+	{ WMI_ROAM_SCAN_RSSI_CHANGE_THRESHOLD,      "ROAM_SCAN_RSSI_CHANGE_THRESHOLD" },
+	{ WMI_ROAM_AP_PROFILE,                      "ROAM_AP_PROFILE" },
 	
 	/* Offload commands */
-	case WMI_SET_ARP_NS_OFFLOAD_CMDID: return "SET_ARP_NS_OFFLOAD";
-	case WMI_SET_PASSPOINT_NETWORK_LIST_CMDID: return "SET_PASSPOINT_NETWORK_LIST";
-	case WMI_SET_EPNO_NETWORK_LIST_CMDID: return "SET_EPNO_NETWORK_LIST";
+	{ WMI_SET_ARP_NS_OFFLOAD_CMDID,             "SET_ARP_NS_OFFLOAD" },
+	{ WMI_SET_PASSPOINT_NETWORK_LIST_CMDID,     "SET_PASSPOINT_NETWORK_LIST" },
+	{ WMI_SET_EPNO_NETWORK_LIST_CMDID,          "SET_EPNO_NETWORK_LIST" },
 	
 	/* GTK offload */
-	case WMI_GTK_OFFLOAD_CMDID: return "GTK_OFFLOAD";
-	
-	/* CSA */
-	case WMI_CSA_OFFLOAD_ENABLE_CMDID: return "CSA_OFFLOAD_ENABLE";
-	case WMI_CSA_OFFLOAD_CHANSWITCH_CMDID: return "CSA_OFFLOAD_CHANSWITCH";
-	
-	/* CHATTER */
-	case WMI_CHATTER_SET_MODE_CMDID: return "CHATTER_SET_MODE";
-	
-	/* ADDBA */
-	case WMI_ADDBA_CLEAR_RESP_CMDID: return "ADDBA_CLEAR_RESP";
-	case WMI_ADDBA_SEND_CMDID: return "ADDBA_SEND";
-	case WMI_ADDBA_STATUS_CMDID: return "ADDBA_STATUS";
-	case WMI_DELBA_SEND_CMDID: return "DELBA_SEND";
-	case WMI_ADDBA_SET_RESP_CMDID: return "ADDBA_SET_RESP";
-	case WMI_SEND_SINGLEAMSDU_CMDID: return "SEND_SINGLEAMSDU";
-	
-	/* Station list */
-	case WMI_STA_KEEPALIVE_CMD: return "STA_KEEPALIVE";
-	case WMI_STA_KEEPALIVE_ARP_RESPONSE: return "STA_KEEPALIVE_ARP_RESPONSE";
-	
-	/* WOW */
-	case WMI_WOW_ADD_WAKE_PATTERN_CMDID: return "WOW_ADD_WAKE_PATTERN";
-	case WMI_WOW_DEL_WAKE_PATTERN_CMDID: return "WOW_DEL_WAKE_PATTERN";
-	case WMI_WOW_ENABLE_DISABLE_WAKE_EVENT_CMDID: return "WOW_ENABLE_DISABLE_WAKE_EVENT";
-	case WMI_WOW_ENABLE_CMDID: return "WOW_ENABLE";
-	case WMI_WOW_HOSTWAKEUP_FROM_SLEEP_CMDID: return "WOW_HOSTWAKEUP_FROM_SLEEP";
-	
-	/* RTT */
-	case WMI_RTT_MEASREQ_CMDID: return "RTT_MEASREQ";
-	case WMI_RTT_TSF_CMDID: return "RTT_TSF";
-	
-	/* Spectral scan */
-	case WMI_PDEV_SPECTRAL_SCAN_ENABLE_CMDID: return "PDEV_SPECTRAL_SCAN_ENABLE";
-	case WMI_PDEV_SPECTRAL_SCAN_DISABLE_CMDID: return "PDEV_SPECTRAL_SCAN_DISABLE";
-	
-	/* NAN */
-	case WMI_NAN_CMDID: return "NAN";
-	
-	/* Coex */
-	case WMI_COEX_CONFIG_CMDID: return "COEX_CONFIG";
-	
-	/* LPI */
-	case WMI_LPI_MGMT_SNOOPING_CONFIG_CMDID: return "LPI_MGMT_SNOOPING_CONFIG";
-	case WMI_LPI_START_SCAN_CMDID: return "LPI_START_SCAN";
-	case WMI_LPI_STOP_SCAN_CMDID: return "LPI_STOP_SCAN";
-	
-	/* Thermal */
-	case WMI_PDEV_SET_THERMAL_THROTTLING_CMDID: return "PDEV_SET_THERMAL_THROTTLING";
-	
-	/* Debug/logging */
-	case WMI_DBGLOG_CFG_CMDID: return "DBGLOG_CFG";
-	case WMI_DBGLOG_TIME_STAMP_SYNC_CMDID: return "DBGLOG_TIME_STAMP_SYNC";
-	
-	/* Firmware test */
-	case WMI_PDEV_UTF_CMDID: return "PDEV_UTF";
-	case WMI_PDEV_QVIT_CMDID: return "PDEV_QVIT";
-	
-	/* Misc */
-	case WMI_ECHO_CMDID: return "ECHO";
-	case WMI_PDEV_FTM_INTG_CMDID: return "PDEV_FTM_INTG";
-	case WMI_VDEV_SET_KEEPALIVE_CMDID: return "VDEV_SET_KEEPALIVE";
-	case WMI_VDEV_GET_KEEPALIVE_CMDID: return "VDEV_GET_KEEPALIVE";
-	case WMI_FORCE_FW_HANG_CMDID: return "FORCE_FW_HANG";
-	
-	/* GPIO */
-	case WMI_GPIO_CONFIG_CMDID: return "GPIO_CONFIG";
-	case WMI_GPIO_OUTPUT_CMDID: return "GPIO_OUTPUT";
-	
-	/* Peer rate */
-	case WMI_PEER_SET_RATE_REPORT_CONDITION_CMDID: return "PEER_SET_RATE_REPORT_CONDITION";
-	
-	/* TDLS */
-	case WMI_TDLS_SET_STATE_CMDID: return "TDLS_SET_STATE";
-	case WMI_TDLS_PEER_UPDATE_CMDID: return "TDLS_PEER_UPDATE";
-	
-	/* Host offload */
-	case WMI_SET_DHCP_SERVER_OFFLOAD_CMDID: return "SET_DHCP_SERVER_OFFLOAD";
-	case WMI_SET_LED_FLASHING_CMDID: return "SET_LED_FLASHING";
-	case WMI_MDNS_OFFLOAD_ENABLE_CMDID: return "MDNS_OFFLOAD_ENABLE";
-	case WMI_MDNS_SET_FQDN_CMDID: return "MDNS_SET_FQDN";
-	case WMI_MDNS_SET_RESPONSE_CMDID: return "MDNS_SET_RESPONSE";
-	case WMI_MDNS_GET_STATS_CMDID: return "MDNS_GET_STATS";
-	
-	/* OCB */
-	case WMI_OCB_SET_SCHED_CMDID: return "OCB_SET_SCHED";
-	case WMI_OCB_SET_CONFIG_CMDID: return "OCB_SET_CONFIG";
-	case WMI_OCB_SET_UTC_TIME_CMDID: return "OCB_SET_UTC_TIME";
-	case WMI_OCB_START_TIMING_ADVERT_CMDID: return "OCB_START_TIMING_ADVERT";
-	case WMI_OCB_STOP_TIMING_ADVERT_CMDID: return "OCB_STOP_TIMING_ADVERT";
-	case WMI_OCB_GET_TSF_TIMER_CMDID: return "OCB_GET_TSF_TIMER";
-	
-	/* System-level */
-	case WMI_PDEV_GET_TEMPERATURE_CMDID: return "PDEV_GET_TEMPERATURE";
-	case WMI_SET_ANTENNA_DIVERSITY_CMDID: return "SET_ANTENNA_DIVERSITY";
-	
-	/* DFS */
-	case WMI_PDEV_DFS_ENABLE_CMDID: return "PDEV_DFS_ENABLE";
-	case WMI_PDEV_DFS_DISABLE_CMDID: return "PDEV_DFS_DISABLE";
-	case WMI_DFS_PHYERR_FILTER_ENA_CMDID: return "DFS_PHYERR_FILTER_ENA";
-	case WMI_DFS_PHYERR_FILTER_DIS_CMDID: return "DFS_PHYERR_FILTER_DIS";
+	{ WMI_GTK_OFFLOAD_CMDID,                    "GTK_OFFLOAD" },
+	
+	/* CSA (Channel Switch Announcement) */
+	{ WMI_CSA_OFFLOAD_ENABLE_CMDID,             "CSA_OFFLOAD_ENABLE" },
+	{ WMI_CSA_OFFLOAD_CHANSWITCH_CMDID,         "CSA_OFFLOAD_CHANSWITCH" },
+	
+	/* CHATTER commands */
+	{ WMI_CHATTER_SET_MODE_CMDID,               "CHATTER_SET_MODE" },
+	
+	/* ADDBA (Add Block Ack) commands */
+	{ WMI_ADDBA_CLEAR_RESP_CMDID,               "ADDBA_CLEAR_RESP" },
+	{ WMI_ADDBA_SEND_CMDID,                     "ADDBA_SEND" },
+	{ WMI_ADDBA_STATUS_CMDID,                   "ADDBA_STATUS" },
+	{ WMI_DELBA_SEND_CMDID,                     "DELBA_SEND" },
+	{ WMI_ADDBA_SET_RESP_CMDID,                 "ADDBA_SET_RESP" },
+	{ WMI_SEND_SINGLEAMSDU_CMDID,               "SEND_SINGLEAMSDU" },
+	
+	/* Station list commands */
+	{ WMI_STA_KEEPALIVE_CMD,                    "STA_KEEPALIVE_CMD" },
+	{ WMI_STA_KEEPALIVE_ARP_RESPONSE,           "STA_KEEPALIVE_ARP_RESPONSE" },
+	
+	/* WOW (Wake on Wireless) commands */
+	{ WMI_WOW_ADD_WAKE_PATTERN_CMDID,           "WOW_ADD_WAKE_PATTERN" },
+	{ WMI_WOW_DEL_WAKE_PATTERN_CMDID,           "WOW_DEL_WAKE_PATTERN" },
+	{ WMI_WOW_ENABLE_DISABLE_WAKE_EVENT_CMDID,  "WOW_ENABLE_DISABLE_WAKE_EVENT" },
+	{ WMI_WOW_ENABLE_CMDID,                     "WOW_ENABLE" },
+	{ WMI_WOW_HOSTWAKEUP_FROM_SLEEP_CMDID,      "WOW_HOSTWAKEUP_FROM_SLEEP" },
+	
+	/* RTT (Round Trip Time) commands */
+	{ WMI_RTT_MEASREQ_CMDID,                    "RTT_MEASREQ" },
+	{ WMI_RTT_TSF_CMDID,                        "RTT_TSF" },
+	
+	/* Spectral scan commands */
+	{ WMI_PDEV_SPECTRAL_SCAN_ENABLE_CMDID,      "PDEV_SPECTRAL_SCAN_ENABLE" },
+	{ WMI_PDEV_SPECTRAL_SCAN_DISABLE_CMDID,     "PDEV_SPECTRAL_SCAN_DISABLE" },
+	
+	/* NAN (Neighbor Awareness Networking) */
+	{ WMI_NAN_CMDID,                            "NAN" },
+	
+	/* Coex (Coexistence) commands */
+	{ WMI_COEX_CONFIG_CMDID,                    "COEX_CONFIG" },
+	
+	/* LPI (Low Power Indoor) commands */
+	{ WMI_LPI_MGMT_SNOOPING_CONFIG_CMDID,       "LPI_MGMT_SNOOPING_CONFIG" },
+	{ WMI_LPI_START_SCAN_CMDID,                 "LPI_START_SCAN" },
+	{ WMI_LPI_STOP_SCAN_CMDID,                  "LPI_STOP_SCAN" },
+	
+	/* Thermal management */
+	{ WMI_PDEV_SET_THERMAL_THROTTLING_CMDID,    "PDEV_SET_THERMAL_THROTTLING" },
+	
+	/* Debug/logging commands */
+	{ WMI_DBGLOG_CFG_CMDID,                     "DBGLOG_CFG" },
+	{ WMI_DBGLOG_TIME_STAMP_SYNC_CMDID,         "DBGLOG_TIME_STAMP_SYNC" },
+	
+	/* Firmware test commands */
+	{ WMI_PDEV_UTF_CMDID,                       "PDEV_UTF" },
+	{ WMI_PDEV_QVIT_CMDID,                      "PDEV_QVIT" },
+	
+	/* Misc commands */
+	{ WMI_ECHO_CMDID,                           "ECHO" },
+	{ WMI_PDEV_FTM_INTG_CMDID,                  "PDEV_FTM_INTG" },
+	{ WMI_VDEV_SET_KEEPALIVE_CMDID,             "VDEV_SET_KEEPALIVE" },
+	{ WMI_VDEV_GET_KEEPALIVE_CMDID,             "VDEV_GET_KEEPALIVE" },
+	{ WMI_FORCE_FW_HANG_CMDID,                  "FORCE_FW_HANG" },
+	
+	/* GPIO commands */
+	{ WMI_GPIO_CONFIG_CMDID,                    "GPIO_CONFIG" },
+	{ WMI_GPIO_OUTPUT_CMDID,                    "GPIO_OUTPUT" },
+	
+	/* Peer rate commands */
+	{ WMI_PEER_SET_RATE_REPORT_CONDITION_CMDID, "PEER_SET_RATE_REPORT_CONDITION" },
+	
+	/* TDLS commands */
+	{ WMI_TDLS_SET_STATE_CMDID,                 "TDLS_SET_STATE" },
+	{ WMI_TDLS_PEER_UPDATE_CMDID,               "TDLS_PEER_UPDATE" },
+	
+	/* Host offload commands */
+	{ WMI_SET_DHCP_SERVER_OFFLOAD_CMDID,        "SET_DHCP_SERVER_OFFLOAD" },
+	{ WMI_SET_LED_FLASHING_CMDID,               "SET_LED_FLASHING" },
+	{ WMI_MDNS_OFFLOAD_ENABLE_CMDID,            "MDNS_OFFLOAD_ENABLE" },
+	{ WMI_MDNS_SET_FQDN_CMDID,                  "MDNS_SET_FQDN" },
+	{ WMI_MDNS_SET_RESPONSE_CMDID,              "MDNS_SET_RESPONSE" },
+	{ WMI_MDNS_GET_STATS_CMDID,                 "MDNS_GET_STATS" },
+	
+	/* OCB (Outside Context of BSS) commands */
+	{ WMI_OCB_SET_SCHED_CMDID,                  "OCB_SET_SCHED" },
+	{ WMI_OCB_SET_CONFIG_CMDID,                 "OCB_SET_CONFIG" },
+	{ WMI_OCB_SET_UTC_TIME_CMDID,               "OCB_SET_UTC_TIME" },
+	{ WMI_OCB_START_TIMING_ADVERT_CMDID,        "OCB_START_TIMING_ADVERT" },
+	{ WMI_OCB_STOP_TIMING_ADVERT_CMDID,         "OCB_STOP_TIMING_ADVERT" },
+	{ WMI_OCB_GET_TSF_TIMER_CMDID,              "OCB_GET_TSF_TIMER" },
+	
+	/* System-level commands */
+	{ WMI_PDEV_GET_TEMPERATURE_CMDID,           "PDEV_GET_TEMPERATURE" },
+	{ WMI_SET_ANTENNA_DIVERSITY_CMDID,          "SET_ANTENNA_DIVERSITY" },
+	
+	/* DFS (Dynamic Frequency Selection) commands */
+	{ WMI_PDEV_DFS_ENABLE_CMDID,                "PDEV_DFS_ENABLE" },
+	{ WMI_PDEV_DFS_DISABLE_CMDID,               "PDEV_DFS_DISABLE" },
+	{ WMI_DFS_PHYERR_FILTER_ENA_CMDID,          "DFS_PHYERR_FILTER_ENA" },
+	{ WMI_DFS_PHYERR_FILTER_DIS_CMDID,          "DFS_PHYERR_FILTER_DIS" },
 	
 	/* Packet filtering */
-	case WMI_PACKET_FILTER_CONFIG_CMDID: return "PACKET_FILTER_CONFIG";
-	case WMI_PACKET_FILTER_ENABLE_CMDID: return "PACKET_FILTER_ENABLE";
-	
-	/* MAWC */
-	case WMI_MAWC_SENSOR_REPORT_IND_CMDID: return "MAWC_SENSOR_REPORT_IND";
+	{ WMI_PACKET_FILTER_CONFIG_CMDID,           "PACKET_FILTER_CONFIG" },
+	{ WMI_PACKET_FILTER_ENABLE_CMDID,           "PACKET_FILTER_ENABLE" },
+	
+	/* MAWC (Motion Aided WiFi Connectivity) */
+	{ WMI_MAWC_SENSOR_REPORT_IND_CMDID,         "MAWC_SENSOR_REPORT_IND" },
+	
+	/* BPF (Berkeley Packet Filter) offload */
+	{ WMI_BPF_GET_CAPABILITY_CMDID,             "BPF_GET_CAPABILITY" },
+	{ WMI_BPF_GET_VDEV_STATS_CMDID,             "BPF_GET_VDEV_STATS" },
+	{ WMI_BPF_SET_VDEV_INSTRUCTIONS_CMDID,      "BPF_SET_VDEV_INSTRUCTIONS" },
+	{ WMI_BPF_DEL_VDEV_INSTRUCTIONS_CMDID,      "BPF_DEL_VDEV_INSTRUCTIONS" },
+	
+	/* Vendor specific commands */
+	{ WMI_PDEV_GET_ANI_CCK_CONFIG_CMDID,        "PDEV_GET_ANI_CCK_CONFIG" },
+	{ WMI_PDEV_GET_ANI_OFDM_CONFIG_CMDID,       "PDEV_GET_ANI_OFDM_CONFIG" },
+};
+
+static const struct name_table_entry wmi_stats_entries[] = {
+	{ WMI_STATS_TYPE_BASIC,      "BASIC_STATS" },
+	{ WMI_STATS_TYPE_LINK_LAYER, "LINK_LAYER_STATS" },
+	{ WMI_STATS_TYPE_CONGESTION, "CONGESTION" },
+};
+
+static struct name_table wmi_cmds = NAME_TABLE_INIT(wmi_cmd_entries);
+static struct name_table wmi_stats = NAME_TABLE_INIT(wmi_stats_entries);
+
+/* Convert WMI command ID to string */
+const char *wmi_cmd_to_string(unsigned int cmd_id)
+{
+	const char *name = name_table_name(&wmi_cmds, cmd_id);
 	
-	/* BPF offload */
-	case WMI_BPF_GET_CAPABILITY_CMDID: return "BPF_GET_CAPABILITY";
-	case WMI_BPF_GET_VDEV_STATS_CMDID: return "BPF_GET_VDEV_STATS";
-	case WMI_BPF_SET_VDEV_INSTRUCTIONS_CMDID: return "BPF_SET_VDEV_INSTRUCTIONS";
-	case WMI_BPF_DEL_VDEV_INSTRUCTIONS_CMDID: return "BPF_DEL_VDEV_INSTRUCTIONS";
+	return name ? name : "UNKNOWN";
+}
+
+/* Convert WMI command name to its ID */
+int wmi_cmd_from_string(const char *name, size_t len, unsigned int *cmd_id)
+{
+	uint32_t id;
 	
-	/* Vendor specific */
-	case WMI_PDEV_GET_ANI_CCK_CONFIG_CMDID: return "PDEV_GET_ANI_CCK_CONFIG";
-	case WMI_PDEV_GET_ANI_OFDM_CONFIG_CMDID: return "PDEV_GET_ANI_OFDM_CONFIG";
+	if (!name || !cmd_id)
+		return -1;
 	
-	default:
-		return "UNKNOWN";
+	/* "WMI_START_SCAN_CMDID" or "START_SCAN" */
+	if (len > 4 && memcmp(name, "WMI_", 4) == 0) {
+		name += 4;
+		len -= 4;
+	}
+	if (name_table_find(&wmi_cmds, name, len, &id) ||
+	    (len > 6 && memcmp(name + len - 6, "_CMDID", 6) == 0 &&
+	     name_table_find(&wmi_cmds, name, len - 6, &id))) {
+		*cmd_id = id;
+		return 0;
 	}
+	return -1;
 }
 
 /* Convert stats type ID to string */
 const char *wmi_stats_to_string(unsigned int stats_id)
 {
-	switch (stats_id) {
-	case WMI_STATS_TYPE_BASIC:
-		return "BASIC_STATS";
-	case WMI_STATS_TYPE_LINK_LAYER:
-		return "LINK_LAYER_STATS";
-	case WMI_STATS_TYPE_CONGESTION:
-		return "CONGESTION";
-	default:
-		return "UNKNOWN_STATS";
-	}
+	const char *name = name_table_name(&wmi_stats, stats_id);
+	
+	return name ? name : "UNKNOWN_STATS";
 }
 
 /* Parse WMI command from log string
@@ -285,86 +323,380 @@ int parse_wmi_from_log(const char *log_line, unsigned int *cmd_id, char *cmd_nam
 	return 0;
 }
 
-/* Helper: Parse hex timestamp [0xXXXXXXXXXX] */
-static int parse_hex_timestamp(const char *str, uint64_t *timestamp)
+/* Keywords of the WMI log formats, found by scan_line() */
+enum wmi_keyword {
+	KW_SEND_WMI_COMMAND,
+	KW_WMI_COMMAND,
+	KW_COMMAND_ID,
+	KW_HTC_TAG,
+	KW_LINK_LAYER_STATS,
+	KW_REQUEST_ID,
+	KW_STATS_TYPE,
+	KW_VDEV_ID_LL,
+	KW_PEER_MAC,
+	KW_STATS_REQ,
+	KW_STATS_ID,
+	KW_VDEV_ID,
+	KW_PDEV_ID,
+	KW_RCPI_REQ,
+	KW_TIME_STAMP_SYNC,
+	KW_MODE,
+	KW_TIME_STAMP_LOW,
+	KW_HIGH,
+	KW_COUNT
+};
+
+#define KW(text) { text, sizeof(text) - 1 }
+
+static const struct {
+	const char *text;
+	size_t len;
+} wmi_keywords[KW_COUNT] = {
+	[KW_SEND_WMI_COMMAND] = KW("Send WMI command:"),
+	[KW_WMI_COMMAND]      = KW("WMI command:"),
+	[KW_COMMAND_ID]       = KW("command_id:"),
+	[KW_HTC_TAG]          = KW("htc_tag:"),
+	[KW_LINK_LAYER_STATS] = KW("LINK_LAYER_STATS - Get Request Params"),
+	[KW_REQUEST_ID]       = KW("Request ID:"),
+	[KW_STATS_TYPE]       = KW("Stats Type:"),
+	[KW_VDEV_ID_LL]       = KW("Vdev ID:"),
+	[KW_PEER_MAC]         = KW("Peer MAC Addr:"),
+	[KW_STATS_REQ]        = KW("STATS REQ STATS_ID:"),
+	[KW_STATS_ID]         = KW("STATS_ID:"),
+	[KW_VDEV_ID]          = KW("VDEV_ID:"),
+	[KW_PDEV_ID]          = KW("PDEV_ID:"),
+	[KW_RCPI_REQ]         = KW("RCPI REQ VDEV_ID:"),
+	[KW_TIME_STAMP_SYNC]  = KW("DBGLOG_TIME_STAMP_SYNC_CMDID"),
+	[KW_MODE]             = KW("mode "),
+	[KW_TIME_STAMP_LOW]   = KW("time_stamp low "),
+	[KW_HIGH]             = KW("high "),
+};
+
+#undef KW
+
+/* Where the parts of a log line are, NULL if absent */
+struct wmi_line_scan {
+	const char *keyword[KW_COUNT];  /* First occurrence of each keyword */
+	const char *bracket;            /* First '[' */
+	const char *thread;             /* Thread name, thread_len bytes */
+	size_t thread_len;
+};
+
+static inline int is_digit(unsigned char c)
 {
-	const char *start = strchr(str, '[');
-	if (!start)
-		return -1;
+	return c >= '0' && c <= '9';
+}
+
+static inline int is_space(unsigned char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/* Value of a hex digit, -1 if c is none */
+static inline int hex_value(unsigned char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+/* Letters, digits and underscores make up thread names */
+static inline int is_word(unsigned char c)
+{
+	unsigned char lower = c | 0x20;
 	
-	start++;
-	/* Must start with 0x for hex format */
-	if (strncmp(start, "0x", 2) != 0 && strncmp(start, "0X", 2) != 0)
-		return -1;
+	return (lower >= 'a' && lower <= 'z') || is_digit(c) || c == '_';
+}
+
+/* Note a keyword starting at p, unless an earlier one was found */
+static inline void match_keyword(struct wmi_line_scan *scan, const char *p,
+                                 const char *end, enum wmi_keyword kw)
+{
+	if (!scan->keyword[kw] && (size_t)(end - p) >= wmi_keywords[kw].len &&
+	    p[1] == wmi_keywords[kw].text[1] &&
+	    memcmp(p, wmi_keywords[kw].text, wmi_keywords[kw].len) == 0)
+		scan->keyword[kw] = p;
+}
+
+/* Where scan_line() looks closer: for each first byte of a keyword, the
+ * bytes that can follow it as bits (c - 0x40), and all of them after
+ * '[' and the ':' that ends a thread name */
+#define NEXT(c)  (1ULL << ((c) - 0x40))
+#define ANY_NEXT UINT64_MAX
+
+static const uint64_t scan_stop[256] = {
+	['['] = ANY_NEXT, [':'] = ANY_NEXT,
+	['D'] = NEXT('B'),
+	['L'] = NEXT('I'),
+	['P'] = NEXT('e') | NEXT('D'),
+	['R'] = NEXT('e') | NEXT('C'),
+	['S'] = NEXT('e') | NEXT('t') | NEXT('T'),
+	['V'] = NEXT('d') | NEXT('D'),
+	['W'] = NEXT('M'),
+	['c'] = NEXT('o'),
+	['h'] = NEXT('t') | NEXT('i'),
+	['m'] = NEXT('o'),
+	['t'] = NEXT('i'),
+};
+
+#undef NEXT
+
+/* Note whatever starts at p, one of the bytes in scan_stop */
+static inline void scan_at(const char *line, const char *p, const char *end,
+                           size_t thread_size, struct wmi_line_scan *scan)
+{
+	uint64_t next = scan_stop[(unsigned char)*p];
+	
+	/* Outside 0x40-0x7f the shift wraps, at worst a needless compare */
+	if (next != ANY_NEXT && !((next >> (((unsigned char)p[1] - 0x40) & 63)) & 1))
+		return;
+	
+	switch (*p) {
+	case '[':
+		if (!scan->bracket)
+			scan->bracket = p;
+		break;
+	case ':':
+		if (!scan->thread) {
+			const char *word = p;
+			
+			while (word > line && is_word(word[-1]))
+				word--;
+			while (word < p && is_digit(*word))
+				word++;
+			if (word < p && (size_t)(p - word) < thread_size) {
+				scan->thread = word;
+				scan->thread_len = p - word;
+			}
+		}
+		break;
+	case 'D':
+		match_keyword(scan, p, end, KW_TIME_STAMP_SYNC);
+		break;
+	case 'L':
+		match_keyword(scan, p, end, KW_LINK_LAYER_STATS);
+		break;
+	case 'P':
+		match_keyword(scan, p, end, KW_PEER_MAC);
+		match_keyword(scan, p, end, KW_PDEV_ID);
+		break;
+	case 'R':
+		match_keyword(scan, p, end, KW_REQUEST_ID);
+		match_keyword(scan, p, end, KW_RCPI_REQ);
+		break;
+	case 'S':
+		match_keyword(scan, p, end, KW_SEND_WMI_COMMAND);
+		match_keyword(scan, p, end, KW_STATS_TYPE);
+		match_keyword(scan, p, end, KW_STATS_REQ);
+		match_keyword(scan, p, end, KW_STATS_ID);
+		break;
+	case 'V':
+		match_keyword(scan, p, end, KW_VDEV_ID_LL);
+		match_keyword(scan, p, end, KW_VDEV_ID);
+		break;
+	case 'W':
+		match_keyword(scan, p, end, KW_WMI_COMMAND);
+		break;
+	case 'c':
+		match_keyword(scan, p, end, KW_COMMAND_ID);
+		break;
+	case 'h':
+		match_keyword(scan, p, end, KW_HTC_TAG);
+		match_keyword(scan, p, end, KW_HIGH);
+		break;
+	case 'm':
+		match_keyword(scan, p, end, KW_MODE);
+		break;
+	case 't':
+		match_keyword(scan, p, end, KW_TIME_STAMP_LOW);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Find the keywords, the first '[' and the thread name in one pass.
+ * Bytes that cannot start anything are skipped through a table, pairs of
+ * bytes no keyword starts with are passed over,
+ * and only keywords starting with the bytes at hand are compared.
+ *
+ * The thread name is the first word followed by ':' shorter than
+ * thread_size, not counting the digits a word starts with ("schedu:",
+ * "wpa_su:").
+ */
+static void scan_line(const char *line, const char *end, size_t thread_size,
+                      struct wmi_line_scan *scan)
+{
+	const char *p = line;
 	
-	start += 2;
-	char *end;
-	*timestamp = strtoull(start, &end, 16);
-	return (end > start) ? 0 : -1;
+	memset(scan, 0, sizeof(*scan));
+	
+	for (; p < end; p++) {
+		if (scan_stop[(unsigned char)*p])
+			scan_at(line, p, end, thread_size, scan);
+	}
 }
 
-/* Helper: Parse time format [HH:MM:SS.microseconds] */
-static int parse_time_format(const char *str, uint64_t *timestamp)
+/* Parse a decimal number like strtoul(), 0 if there is none */
+static uint64_t parse_decimal(const char *p)
 {
-	const char *start = strchr(str, '[');
-	if (!start)
-		return -1;
+	uint64_t value = 0;
+	int negative = 0;
 	
-	start++;
-	int hour, min, sec, usec;
-	if (sscanf(start, "%d:%d:%d.%d", &hour, &min, &sec, &usec) == 4) {
-		/* Convert to microseconds (relative time) */
-		*timestamp = ((uint64_t)hour * 3600 + min * 60 + sec) * 1000000ULL + usec;
-		return 0;
+	while (is_space(*p))
+		p++;
+	
+	if (*p == '+' || *p == '-')
+		negative = *p++ == '-';
+	
+	for (; is_digit(*p); p++) {
+		unsigned int digit = *p - '0';
+		
+		if (value > (UINT64_MAX - digit) / 10)
+			value = UINT64_MAX;
+		else
+			value = value * 10 + digit;
 	}
 	
-	return -1;
+	return negative && value != UINT64_MAX ? -value : value;
 }
 
-/* Helper: Validate MAC address format */
-static int validate_mac_address(const char *mac)
+/* Value of the number after a keyword, 0 if the keyword is absent */
+static uint32_t keyword_value(const struct wmi_line_scan *scan, enum wmi_keyword kw)
 {
-	if (!mac)
+	if (!scan->keyword[kw])
 		return 0;
 	
-	/* MAC should be XX:XX:XX:XX:XX:XX (17 chars) */
-	if (strlen(mac) != 17)
-		return 0;
+	return (uint32_t)parse_decimal(scan->keyword[kw] + wmi_keywords[kw].len);
+}
+
+/* Parse a signed decimal like %d, returns the end or NULL if there is none */
+static const char *parse_int(const char *p, int *value)
+{
+	int negative = 0;
+	unsigned int v = 0;
+	
+	while (is_space(*p))
+		p++;
+	
+	if (*p == '+' || *p == '-')
+		negative = *p++ == '-';
 	
-	for (int i = 0; i < 17; i++) {
-		if (i % 3 == 2) {
-			if (mac[i] != ':')
-				return 0;
+	if (!is_digit(*p))
+		return NULL;
+	
+	for (; is_digit(*p); p++)
+		v = v * 10 + (*p - '0');
+	
+	*value = negative ? -(int)v : (int)v;
+	return p;
+}
+
+/* Helper: Parse hex timestamp [0xXXXXXXXXXX], p points past the '[' */
+static int parse_hex_timestamp(const char *p, uint64_t *timestamp)
+{
+	uint64_t value = 0;
+	int digit;
+	
+	/* Must start with 0x for hex format */
+	if (p[0] != '0' || (p[1] | 0x20) != 'x')
+		return -1;
+	
+	p += 2;
+	while (is_space(*p))
+		p++;
+	if (hex_value(*p) < 0)
+		return -1;
+	
+	for (; (digit = hex_value(*p)) >= 0; p++)
+		value = value > UINT64_MAX >> 4 ? UINT64_MAX : value << 4 | digit;
+	
+	*timestamp = value;
+	return 0;
+}
+
+/* Helper: Parse time format [HH:MM:SS.microseconds], p points past the '[' */
+static int parse_time_format(const char *p, uint64_t *timestamp)
+{
+	int hour, min, sec, usec;
+	
+	if (!(p = parse_int(p, &hour)) || *p++ != ':' ||
+	    !(p = parse_int(p, &min)) || *p++ != ':' ||
+	    !(p = parse_int(p, &sec)) || *p++ != '.' ||
+	    !parse_int(p, &usec))
+		return -1;
+	
+	/* Convert to microseconds (relative time) */
+	*timestamp = ((uint64_t)hour * 3600 + min * 60 + sec) * 1000000ULL + usec;
+	return 0;
+}
+
+/* Copy len bytes into a string field, truncating to fit */
+static void copy_field(char *dst, size_t size, const char *src, size_t len)
+{
+	if (len >= size)
+		len = size - 1;
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+}
+
+/* Set a string field to a constant */
+#define SET_FIELD(field, text) copy_field(field, sizeof(field), text, sizeof(text) - 1)
+
+/* Helper: Extract the peer MAC address (XX:XX:XX:XX:XX:XX) after p */
+static void parse_peer_mac(const char *p, struct wmi_log_entry *entry)
+{
+	int i, valid = 1;
+	
+	while (*p == ' ')
+		p++;
+	
+	/* Take up to 17 hex digits and colons, checking the layout as we go */
+	for (i = 0; i < 17; i++) {
+		unsigned char c = p[i];
+		
+		if (c == ':') {
+			if (i % 3 != 2)
+				valid = 0;
+		} else if (hex_value(c) >= 0) {
+			if (i % 3 == 2)
+				valid = 0;
 		} else {
-			if (!isxdigit(mac[i]))
-				return 0;
+			break;
 		}
+		entry->peer_mac[i] = c;
 	}
+	entry->peer_mac[i] = '\0';
 	
-	return 1;
+	/* Validate MAC address */
+	if (i == 17) {
+		if (valid) {
+			entry->has_peer = 1;
+		} else {
+			WMI_LOG_WARNING_FMT(WMI_ERR_INVALID_MAC,
+			                   "Invalid MAC address: %s", entry->peer_mac);
+			record_parse_error(WMI_ERR_INVALID_MAC, entry->peer_mac);
+			entry->peer_mac[0] = '\0';
+		}
+	} else if (i > 0) {
+		WMI_LOG_WARNING_FMT(WMI_ERR_INVALID_MAC,
+		                   "Incomplete MAC address: %d chars", i);
+		record_parse_error(WMI_ERR_INVALID_MAC, "Incomplete MAC");
+		entry->peer_mac[0] = '\0';
+	}
 }
 
-/* Helper: Extract thread name from log line */
-static void extract_thread_name(const char *log_line, char *thread_name, size_t len)
+/* Set the stats type from stats_id */
+static void set_stats(struct wmi_log_entry *entry, uint32_t stats_id)
 {
-	/* Look for patterns like "schedu:", "wpa_su:", etc. */
-	const char *p = log_line;
-	while (*p) {
-		if (isalpha(*p) || *p == '_') {
-			const char *start = p;
-			while (isalnum(*p) || *p == '_')
-				p++;
-			
-			if (*p == ':' && (p - start) < (int)len) {
-				size_t name_len = p - start;
-				strncpy(thread_name, start, name_len);
-				thread_name[name_len] = '\0';
-				return;
-			}
-		}
-		p++;
-	}
-	thread_name[0] = '\0';
+	const char *name = wmi_stats_to_string(stats_id);
+	
+	entry->stats_id = stats_id;
+	copy_field(entry->stats_type, sizeof(entry->stats_type), name, strlen(name));
+	entry->has_stats = 1;
 }
 
 /* Parse WMI log line into structured entry
@@ -374,18 +706,23 @@ static void extract_thread_name(const char *log_line, char *thread_name, size_t
  * 3. "STATS REQ STATS_ID:XXXX VDEV_ID:X PDEV_ID:X-->"
  * 4. "RCPI REQ VDEV_ID:X-->"
  * 5. "send_time_stamp_sync_cmd_tlv: XXXX: WMA --> DBGLOG_TIME_STAMP_SYNC_CMDID mode X time_stamp low XXXX high XXXX"
+ *
+ * The line is tokenized in a single pass that classifies it and finds
+ * every field, see scan_line(); the fields are then read in place.
  */
 int wmi_parse_log_line(const char *log_line, struct wmi_log_entry *entry)
 {
+	struct wmi_line_scan scan;
+	
 	if (!log_line) {
 		WMI_LOG_ERROR(WMI_ERR_NULL_POINTER, "log_line is NULL");
-		wmi_error_stats_record(&g_wmi_parse_stats, WMI_ERR_NULL_POINTER, NULL);
+		record_parse_error(WMI_ERR_NULL_POINTER, NULL);
 		return WMI_ERR_NULL_POINTER;
 	}
 	
 	if (!entry) {
 		WMI_LOG_ERROR(WMI_ERR_NULL_POINTER, "entry is NULL");
-		wmi_error_stats_record(&g_wmi_parse_stats, WMI_ERR_NULL_POINTER, NULL);
+		record_parse_error(WMI_ERR_NULL_POINTER, NULL);
 		return WMI_ERR_NULL_POINTER;
 	}
 	
@@ -394,199 +731,117 @@ int wmi_parse_log_line(const char *log_line, struct wmi_log_entry *entry)
 	if (line_len < 10) {
 		WMI_LOG_WARNING_FMT(WMI_ERR_TRUNCATED_LINE, 
 		                   "Line too short: %zu bytes", line_len);
-		wmi_error_stats_record(&g_wmi_parse_stats, WMI_ERR_TRUNCATED_LINE,
-		                      "Line too short");
+		record_parse_error(WMI_ERR_TRUNCATED_LINE, "Line too short");
 		return WMI_ERR_TRUNCATED_LINE;
 	}
 	
 	/* Track total operations */
-	g_wmi_parse_stats.total_operations++;
+	atomic_fetch_add_explicit(&g_wmi_parse_operations, 1, memory_order_relaxed);
 	
 	/* Initialize entry */
 	memset(entry, 0, sizeof(*entry));
 	
+	scan_line(log_line, log_line + line_len, sizeof(entry->thread_name), &scan);
+	
 	/* Extract thread name */
-	extract_thread_name(log_line, entry->thread_name, sizeof(entry->thread_name));
+	if (scan.thread)
+		copy_field(entry->thread_name, sizeof(entry->thread_name),
+		           scan.thread, scan.thread_len);
 	
 	/* Try to parse timestamp */
-	if (parse_hex_timestamp(log_line, &entry->timestamp) == 0 ||
-	    parse_time_format(log_line, &entry->timestamp) == 0) {
+	if (scan.bracket &&
+	    (parse_hex_timestamp(scan.bracket + 1, &entry->timestamp) == 0 ||
+	     parse_time_format(scan.bracket + 1, &entry->timestamp) == 0)) {
 		entry->has_timestamp = 1;
 	}
 	
 	/* Format 1: "Send WMI command:" */
-	if (strstr(log_line, "Send WMI command:")) {
-		const char *cmd_start = strstr(log_line, "WMI command:");
-		if (cmd_start) {
-			cmd_start += 12;
-			
-			/* Extract command name */
-			const char *cmd_end = strstr(cmd_start, " command_id:");
-			if (cmd_end) {
-				size_t len = cmd_end - cmd_start;
-				if (len >= sizeof(entry->command_name))
-					len = sizeof(entry->command_name) - 1;
-				strncpy(entry->command_name, cmd_start, len);
-				entry->command_name[len] = '\0';
-			}
+	if (scan.keyword[KW_SEND_WMI_COMMAND]) {
+		const char *cmd_start = scan.keyword[KW_WMI_COMMAND] + wmi_keywords[KW_WMI_COMMAND].len;
+		const char *id_str = scan.keyword[KW_COMMAND_ID];
+		
+		/* Extract command name, up to " command_id:" */
+		if (id_str && id_str > cmd_start && id_str[-1] == ' ') {
+			copy_field(entry->command_name, sizeof(entry->command_name),
+			           cmd_start, id_str - 1 - cmd_start);
+		} else if (!id_str) {
+			/* No ID logged, go by the name up to the next space */
+			const char *name_end = cmd_start;
+			unsigned int cmd_id;
 			
-			/* Parse command_id */
-			const char *id_str = strstr(log_line, "command_id:");
-			if (id_str) {
-				entry->cmd_id = strtoul(id_str + 11, NULL, 10);
-				
-				/* Check if command ID is known */
-				const char *cmd_name = wmi_cmd_to_string(entry->cmd_id);
-				if (strcmp(cmd_name, "UNKNOWN") == 0) {
-					WMI_LOG_WARNING_FMT(WMI_ERR_INVALID_CMD_ID,
-					                   "Unknown command ID: 0x%x", entry->cmd_id);
-					wmi_error_stats_record(&g_wmi_parse_stats, 
-					                      WMI_ERR_INVALID_CMD_ID,
-					                      "Unknown command ID");
-				}
-			}
+			while (*name_end && !is_space(*name_end))
+				name_end++;
+			copy_field(entry->command_name, sizeof(entry->command_name),
+			           cmd_start, name_end - cmd_start);
+			if (wmi_cmd_from_string(cmd_start, name_end - cmd_start, &cmd_id) == 0)
+				entry->cmd_id = cmd_id;
+		}
+		
+		/* Parse command_id */
+		if (id_str) {
+			entry->cmd_id = keyword_value(&scan, KW_COMMAND_ID);
 			
-			/* Parse htc_tag */
-			const char *tag_str = strstr(log_line, "htc_tag:");
-			if (tag_str) {
-				entry->htc_tag = strtoul(tag_str + 8, NULL, 10);
+			/* Check if command ID is known */
+			if (!name_table_name(&wmi_cmds, entry->cmd_id)) {
+				WMI_LOG_WARNING_FMT(WMI_ERR_INVALID_CMD_ID,
+				                   "Unknown command ID: 0x%x", entry->cmd_id);
+				record_parse_error(WMI_ERR_INVALID_CMD_ID, "Unknown command ID");
 			}
-			
-			return WMI_SUCCESS;
 		}
+		
+		/* Parse htc_tag */
+		entry->htc_tag = keyword_value(&scan, KW_HTC_TAG);
+		
+		return WMI_SUCCESS;
 	}
 	
 	/* Format 2: "LINK_LAYER_STATS - Get Request Params" */
-	if (strstr(log_line, "LINK_LAYER_STATS - Get Request Params")) {
+	if (scan.keyword[KW_LINK_LAYER_STATS]) {
 		entry->cmd_id = WMI_REQUEST_LINK_STATS_CMDID;
-		snprintf(entry->command_name, sizeof(entry->command_name), "REQUEST_LINK_STATS");
-		
-		/* Parse Request ID */
-		const char *req_str = strstr(log_line, "Request ID:");
-		if (req_str) {
-			entry->req_id = strtoul(req_str + 11, NULL, 10);
-		}
-		
-		/* Parse Stats Type */
-		const char *stats_str = strstr(log_line, "Stats Type:");
-		if (stats_str) {
-			entry->stats_id = strtoul(stats_str + 11, NULL, 10);
-			snprintf(entry->stats_type, sizeof(entry->stats_type), "%s",
-			         wmi_stats_to_string(entry->stats_id));
-			entry->has_stats = 1;
-		}
+		SET_FIELD(entry->command_name, "REQUEST_LINK_STATS");
 		
-		/* Parse Vdev ID */
-		const char *vdev_str = strstr(log_line, "Vdev ID:");
-		if (vdev_str) {
-			entry->vdev_id = strtoul(vdev_str + 8, NULL, 10);
-		}
+		entry->req_id = keyword_value(&scan, KW_REQUEST_ID);
+		if (scan.keyword[KW_STATS_TYPE])
+			set_stats(entry, keyword_value(&scan, KW_STATS_TYPE));
+		entry->vdev_id = keyword_value(&scan, KW_VDEV_ID_LL);
 		
 		/* Parse Peer MAC Addr */
-		const char *mac_str = strstr(log_line, "Peer MAC Addr:");
-		if (mac_str) {
-			mac_str += 14;
-			while (*mac_str == ' ') mac_str++;
-			
-			/* Extract MAC address */
-			int i;
-			for (i = 0; i < 17 && mac_str[i]; i++) {
-				if (mac_str[i] == ':' || isxdigit(mac_str[i])) {
-					entry->peer_mac[i] = mac_str[i];
-				} else {
-					break;
-				}
-			}
-			entry->peer_mac[i] = '\0';
-			
-			/* Validate MAC address */
-			if (i == 17) {
-				if (validate_mac_address(entry->peer_mac)) {
-					entry->has_peer = 1;
-				} else {
-					WMI_LOG_WARNING_FMT(WMI_ERR_INVALID_MAC,
-					                   "Invalid MAC address: %s", entry->peer_mac);
-					wmi_error_stats_record(&g_wmi_parse_stats, WMI_ERR_INVALID_MAC,
-					                      entry->peer_mac);
-					entry->peer_mac[0] = '\0';
-				}
-			} else if (i > 0) {
-				WMI_LOG_WARNING_FMT(WMI_ERR_INVALID_MAC,
-				                   "Incomplete MAC address: %d chars", i);
-				wmi_error_stats_record(&g_wmi_parse_stats, WMI_ERR_INVALID_MAC,
-				                      "Incomplete MAC");
-				entry->peer_mac[0] = '\0';
-			}
-		}
+		if (scan.keyword[KW_PEER_MAC])
+			parse_peer_mac(scan.keyword[KW_PEER_MAC] + wmi_keywords[KW_PEER_MAC].len, entry);
 		
 		return WMI_SUCCESS;
 	}
 	
 	/* Format 3: "STATS REQ STATS_ID:" */
-	if (strstr(log_line, "STATS REQ STATS_ID:")) {
+	if (scan.keyword[KW_STATS_REQ]) {
 		entry->cmd_id = WMI_REQUEST_STATS_CMDID;
-		snprintf(entry->command_name, sizeof(entry->command_name), "REQUEST_STATS");
+		SET_FIELD(entry->command_name, "REQUEST_STATS");
 		
-		/* Parse STATS_ID */
-		const char *stats_str = strstr(log_line, "STATS_ID:");
-		if (stats_str) {
-			entry->stats_id = strtoul(stats_str + 9, NULL, 10);
-			snprintf(entry->stats_type, sizeof(entry->stats_type), "%s",
-			         wmi_stats_to_string(entry->stats_id));
-			entry->has_stats = 1;
-		}
-		
-		/* Parse VDEV_ID */
-		const char *vdev_str = strstr(log_line, "VDEV_ID:");
-		if (vdev_str) {
-			entry->vdev_id = strtoul(vdev_str + 8, NULL, 10);
-		}
-		
-		/* Parse PDEV_ID */
-		const char *pdev_str = strstr(log_line, "PDEV_ID:");
-		if (pdev_str) {
-			entry->pdev_id = strtoul(pdev_str + 8, NULL, 10);
-		}
+		set_stats(entry, keyword_value(&scan, KW_STATS_ID));
+		entry->vdev_id = keyword_value(&scan, KW_VDEV_ID);
+		entry->pdev_id = keyword_value(&scan, KW_PDEV_ID);
 		
 		return WMI_SUCCESS;
 	}
 	
 	/* Format 4: "RCPI REQ VDEV_ID:" */
-	if (strstr(log_line, "RCPI REQ VDEV_ID:")) {
+	if (scan.keyword[KW_RCPI_REQ]) {
 		entry->cmd_id = WMI_REQUEST_RCPI_CMDID;
-		snprintf(entry->command_name, sizeof(entry->command_name), "REQUEST_RCPI");
+		SET_FIELD(entry->command_name, "REQUEST_RCPI");
 		
-		/* Parse VDEV_ID */
-		const char *vdev_str = strstr(log_line, "VDEV_ID:");
-		if (vdev_str) {
-			entry->vdev_id = strtoul(vdev_str + 8, NULL, 10);
-		}
+		entry->vdev_id = keyword_value(&scan, KW_VDEV_ID);
 		
 		return WMI_SUCCESS;
 	}
 	
 	/* Format 5: "DBGLOG_TIME_STAMP_SYNC_CMDID" */
-	if (strstr(log_line, "DBGLOG_TIME_STAMP_SYNC_CMDID")) {
+	if (scan.keyword[KW_TIME_STAMP_SYNC]) {
 		entry->cmd_id = WMI_DBGLOG_TIME_STAMP_SYNC_CMDID;
-		snprintf(entry->command_name, sizeof(entry->command_name), "DBGLOG_TIME_STAMP_SYNC");
+		SET_FIELD(entry->command_name, "DBGLOG_TIME_STAMP_SYNC");
 		
-		/* Parse mode */
-		const char *mode_str = strstr(log_line, "mode ");
-		if (mode_str) {
-			entry->mode = strtoul(mode_str + 5, NULL, 10);
-		}
-		
-		/* Parse time_stamp low */
-		const char *low_str = strstr(log_line, "time_stamp low ");
-		if (low_str) {
-			entry->timestamp_low = strtoul(low_str + 15, NULL, 10);
-		}
-		
-		/* Parse time_stamp high */
-		const char *high_str = strstr(log_line, "high ");
-		if (high_str) {
-			entry->timestamp_high = strtoul(high_str + 5, NULL, 10);
-		}
+		entry->mode = keyword_value(&scan, KW_MODE);
+		entry->timestamp_low = keyword_value(&scan, KW_TIME_STAMP_LOW);
+		entry->timestamp_high = keyword_value(&scan, KW_HIGH);
 		
 		return WMI_SUCCESS;
 	}
@@ -594,8 +849,7 @@ int wmi_parse_log_line(const char *log_line, struct wmi_log_entry *entry)
 	/* No recognized format - log warning but don't fail completely */
 	WMI_LOG_WARNING_FMT(WMI_ERR_UNKNOWN_FORMAT,
 	                   "Unknown WMI log format: %.50s...", log_line);
-	wmi_error_stats_record(&g_wmi_parse_stats, WMI_ERR_UNKNOWN_FORMAT,
-	                      "Unrecognized log format");
+	record_parse_error(WMI_ERR_UNKNOWN_FORMAT, "Unrecognized log format");
 	
 	return WMI_ERR_UNKNOWN_FORMAT;
 }
@@ -680,7 +934,11 @@ int wmi_get_parse_stats(struct wmi_error_stats *stats)
 		return WMI_ERR_NULL_POINTER;
 	}
 	
+	pthread_mutex_lock(&g_wmi_parse_lock);
 	*stats = g_wmi_parse_stats;
+	pthread_mutex_unlock(&g_wmi_parse_lock);
+	stats->total_operations += atomic_load_explicit(&g_wmi_parse_operations,
+	                                                memory_order_relaxed);
 	return WMI_SUCCESS;
 }
 
@@ -689,7 +947,10 @@ int wmi_get_parse_stats(struct wmi_error_stats *stats)
  */
 void wmi_reset_parse_stats(void)
 {
+	pthread_mutex_lock(&g_wmi_parse_lock);
 	wmi_error_stats_reset(&g_wmi_parse_stats);
+	atomic_store_explicit(&g_wmi_parse_operations, 0, memory_order_relaxed);
+	pthread_mutex_unlock(&g_wmi_parse_lock);
 }
 
 /**
@@ -697,9 +958,12 @@ void wmi_reset_parse_stats(void)
  */
 void wmi_print_parse_stats(FILE *fp)
 {
+	struct wmi_error_stats stats;
+	
 	if (!fp) {
 		fp = stderr;
 	}
 	
-	wmi_error_stats_print(&g_wmi_parse_stats, fp);
+	wmi_get_parse_stats(&stats);
+	wmi_error_stats_print(&stats, fp);
 }
@@ -1,7 +1,7 @@
 /* rate_limiter.c - Token bucket rate limiter implementation
  *
  * Implements token bucket algorithm for rate limiting with support for
- * per-event-type limits and statistics tracking.
+ * per-event-type limits, per-key sliding windows and statistics tracking.
  */
 
 #include <stdlib.h>
@@ -20,12 +20,29 @@ static double get_time_seconds(void)
 	return tv.tv_sec + tv.tv_usec / 1000000.0;
 }
 
-/* Rate limiter structure */
+/* Monotonic time in nanoseconds, what buckets are kept in */
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Rate limiter structure
+ *
+ * The bucket is kept as the time it will be full again. Until then it
+ * holds burst - (full_at - now) / interval tokens, afterwards burst.
+ * Taking n tokens moves full_at n intervals on, which is allowed while
+ * it stays within burst intervals of now, so a single compare and swap
+ * both refills the bucket and takes from it. Configuration changes and
+ * the rate window are serialized by the mutex, taking tokens never
+ * waits for it.
+ */
 struct rate_limiter {
-	double rate;              /* Tokens per second */
-	double tokens;            /* Current token count */
-	size_t burst;             /* Maximum tokens (bucket capacity) */
-	double last_update;       /* Last update time */
+	_Atomic uint64_t full_at;       /* Nanoseconds when the bucket is full */
+	_Atomic double interval_ns;     /* Nanoseconds per token */
+	_Atomic uint64_t capacity_ns;   /* burst * interval_ns */
+	_Atomic size_t burst;           /* Maximum tokens (bucket capacity) */
 	
 	pthread_mutex_t mutex;
 	
@@ -38,6 +55,107 @@ struct rate_limiter {
 	atomic_ulong rate_window_count;
 };
 
+/* Tokens in a bucket full at full_at, at now */
+static double bucket_tokens(struct rate_limiter *rl, uint64_t full_at, uint64_t now)
+{
+	size_t burst = atomic_load_explicit(&rl->burst, memory_order_relaxed);
+	double tokens;
+	
+	if (full_at <= now)
+		return burst;
+	
+	tokens = burst - (full_at - now) / atomic_load_explicit(&rl->interval_ns,
+	                                                        memory_order_relaxed);
+	return tokens > 0 ? tokens : 0;
+}
+
+/* Switch to interval_ns and burst keeping the tokens, or filling the bucket */
+static void bucket_configure(struct rate_limiter *rl, double interval_ns,
+                             size_t burst, bool fill)
+{
+	uint64_t now = get_time_ns();
+	uint64_t full_at = atomic_load_explicit(&rl->full_at, memory_order_relaxed);
+	uint64_t next;
+	double tokens;
+	
+	do {
+		tokens = fill ? burst : bucket_tokens(rl, full_at, now);
+		if (tokens > burst)
+			tokens = burst;
+		next = now + (uint64_t)((burst - tokens) * interval_ns);
+	} while (!atomic_compare_exchange_weak_explicit(&rl->full_at, &full_at, next,
+	                                                memory_order_relaxed,
+	                                                memory_order_relaxed));
+	
+	/* A take racing with this may still see the old rate */
+	atomic_store_explicit(&rl->interval_ns, interval_ns, memory_order_relaxed);
+	atomic_store_explicit(&rl->capacity_ns, (uint64_t)(burst * interval_ns + 0.5),
+	                      memory_order_relaxed);
+	atomic_store_explicit(&rl->burst, burst, memory_order_relaxed);
+}
+
+/* Take n tokens if the bucket holds them */
+static bool take_tokens(struct rate_limiter *rl, size_t n)
+{
+	uint64_t now = get_time_ns();
+	uint64_t full_at = atomic_load_explicit(&rl->full_at, memory_order_relaxed);
+	uint64_t capacity = atomic_load_explicit(&rl->capacity_ns, memory_order_relaxed);
+	uint64_t cost = (uint64_t)(n * atomic_load_explicit(&rl->interval_ns,
+	                                                    memory_order_relaxed) + 0.5);
+	uint64_t next;
+	
+	do {
+		next = (full_at > now ? full_at : now) + cost;
+		if (next - now > capacity)
+			return false;
+	} while (!atomic_compare_exchange_weak_explicit(&rl->full_at, &full_at, next,
+	                                                memory_order_relaxed,
+	                                                memory_order_relaxed));
+	
+	return true;
+}
+
+/* Give back n tokens taken by take_tokens() */
+static void give_tokens(struct rate_limiter *rl, size_t n)
+{
+	uint64_t now = get_time_ns();
+	uint64_t full_at = atomic_load_explicit(&rl->full_at, memory_order_relaxed);
+	uint64_t cost = (uint64_t)(n * atomic_load_explicit(&rl->interval_ns,
+	                                                    memory_order_relaxed) + 0.5);
+	uint64_t next;
+	
+	do {
+		if (full_at <= now)
+			return;
+		next = full_at - now > cost ? full_at - cost : now;
+	} while (!atomic_compare_exchange_weak_explicit(&rl->full_at, &full_at, next,
+	                                                memory_order_relaxed,
+	                                                memory_order_relaxed));
+}
+
+static void count_events(struct rate_limiter *rl, size_t n, bool allowed)
+{
+	if (!allowed) {
+		atomic_fetch_add_explicit(&rl->denied_count, n, memory_order_relaxed);
+		return;
+	}
+	
+	atomic_fetch_add_explicit(&rl->allowed_count, n, memory_order_relaxed);
+	atomic_fetch_add_explicit(&rl->rate_window_count, n, memory_order_relaxed);
+}
+
+/* Apply a new limit with a full bucket and cleared statistics */
+static void limiter_reconfigure(struct rate_limiter *rl, double rate, size_t burst)
+{
+	pthread_mutex_lock(&rl->mutex);
+	bucket_configure(rl, 1000000000.0 / rate, burst, true);
+	atomic_store_explicit(&rl->allowed_count, 0, memory_order_relaxed);
+	atomic_store_explicit(&rl->denied_count, 0, memory_order_relaxed);
+	atomic_store_explicit(&rl->rate_window_count, 0, memory_order_relaxed);
+	rl->rate_window_start = get_time_seconds();
+	pthread_mutex_unlock(&rl->mutex);
+}
+
 struct rate_limiter *rate_limiter_create(double rate, size_t burst)
 {
 	struct rate_limiter *rl;
@@ -49,11 +167,9 @@ struct rate_limiter *rate_limiter_create(double rate, size_t burst)
 	if (!rl)
 		return NULL;
 	
-	rl->rate = rate;
-	rl->burst = burst;
-	rl->tokens = burst;  /* Start with full bucket */
-	rl->last_update = get_time_seconds();
-	rl->rate_window_start = rl->last_update;
+	/* Start with full bucket */
+	bucket_configure(rl, 1000000000.0 / rate, burst, true);
+	rl->rate_window_start = get_time_seconds();
 	
 	if (pthread_mutex_init(&rl->mutex, NULL) != 0) {
 		free(rl);
@@ -76,79 +192,26 @@ void rate_limiter_destroy(struct rate_limiter *rl)
 	free(rl);
 }
 
-/* Refill tokens based on elapsed time */
-static void refill_tokens(struct rate_limiter *rl)
-{
-	double now, elapsed, new_tokens;
-	
-	now = get_time_seconds();
-	elapsed = now - rl->last_update;
-	
-	if (elapsed > 0) {
-		new_tokens = elapsed * rl->rate;
-		rl->tokens += new_tokens;
-		
-		/* Cap at burst size */
-		if (rl->tokens > rl->burst)
-			rl->tokens = rl->burst;
-		
-		rl->last_update = now;
-	}
-}
-
 bool rate_limiter_allow(struct rate_limiter *rl)
 {
-	bool allowed;
-	
-	if (!rl)
-		return true;
-	
-	pthread_mutex_lock(&rl->mutex);
-	
-	refill_tokens(rl);
-	
-	if (rl->tokens >= 1.0) {
-		rl->tokens -= 1.0;
-		allowed = true;
-		atomic_fetch_add_explicit(&rl->allowed_count, 1, memory_order_relaxed);
-		atomic_fetch_add_explicit(&rl->rate_window_count, 1, memory_order_relaxed);
-	} else {
-		allowed = false;
-		atomic_fetch_add_explicit(&rl->denied_count, 1, memory_order_relaxed);
-	}
-	
-	pthread_mutex_unlock(&rl->mutex);
-	
-	return allowed;
+	return rate_limiter_allow_n(rl, 1);
 }
 
 bool rate_limiter_allow_n(struct rate_limiter *rl, size_t n)
 {
-	bool allowed;
-	
 	if (!rl)
 		return true;
 	
 	if (n == 0)
 		return true;
 	
-	pthread_mutex_lock(&rl->mutex);
-	
-	refill_tokens(rl);
-	
-	if (rl->tokens >= n) {
-		rl->tokens -= n;
-		allowed = true;
-		atomic_fetch_add_explicit(&rl->allowed_count, n, memory_order_relaxed);
-		atomic_fetch_add_explicit(&rl->rate_window_count, n, memory_order_relaxed);
-	} else {
-		allowed = false;
-		atomic_fetch_add_explicit(&rl->denied_count, n, memory_order_relaxed);
+	if (!take_tokens(rl, n)) {
+		count_events(rl, n, false);
+		return false;
 	}
 	
-	pthread_mutex_unlock(&rl->mutex);
-	
-	return allowed;
+	count_events(rl, n, true);
+	return true;
 }
 
 void rate_limiter_reset(struct rate_limiter *rl)
@@ -157,9 +220,8 @@ void rate_limiter_reset(struct rate_limiter *rl)
 		return;
 	
 	pthread_mutex_lock(&rl->mutex);
-	rl->tokens = rl->burst;
-	rl->last_update = get_time_seconds();
-	rl->rate_window_start = rl->last_update;
+	atomic_store_explicit(&rl->full_at, get_time_ns(), memory_order_relaxed);
+	rl->rate_window_start = get_time_seconds();
 	atomic_store_explicit(&rl->rate_window_count, 0, memory_order_relaxed);
 	pthread_mutex_unlock(&rl->mutex);
 }
@@ -170,8 +232,9 @@ void rate_limiter_set_rate(struct rate_limiter *rl, double rate)
 		return;
 	
 	pthread_mutex_lock(&rl->mutex);
-	refill_tokens(rl);  /* Update with old rate first */
-	rl->rate = rate;
+	/* Keep the tokens gathered at the old rate */
+	bucket_configure(rl, 1000000000.0 / rate,
+	                 atomic_load_explicit(&rl->burst, memory_order_relaxed), false);
 	pthread_mutex_unlock(&rl->mutex);
 }
 
@@ -181,25 +244,18 @@ void rate_limiter_set_burst(struct rate_limiter *rl, size_t burst)
 		return;
 	
 	pthread_mutex_lock(&rl->mutex);
-	rl->burst = burst;
-	if (rl->tokens > burst)
-		rl->tokens = burst;
+	bucket_configure(rl, atomic_load_explicit(&rl->interval_ns, memory_order_relaxed),
+	                 burst, false);
 	pthread_mutex_unlock(&rl->mutex);
 }
 
 double rate_limiter_get_tokens(struct rate_limiter *rl)
 {
-	double tokens;
-	
 	if (!rl)
 		return 0;
 	
-	pthread_mutex_lock(&rl->mutex);
-	refill_tokens(rl);
-	tokens = rl->tokens;
-	pthread_mutex_unlock(&rl->mutex);
-	
-	return tokens;
+	return bucket_tokens(rl, atomic_load_explicit(&rl->full_at, memory_order_relaxed),
+	                     get_time_ns());
 }
 
 void rate_limiter_stats(struct rate_limiter *rl,
@@ -237,7 +293,57 @@ void rate_limiter_stats(struct rate_limiter *rl,
 	}
 }
 
-/* Per-event-type rate limiter map */
+/* Per-key sliding windows
+ *
+ * A key hashes to a set of RATE_LIMITER_KEY_WAYS entries under the set's
+ * own mutex. Each entry counts the events of its current window and keeps
+ * the count of the window before; the events of the last window length
+ * are estimated as the current count plus the part of the previous one
+ * the sliding window still overlaps. A key missing from its set takes the
+ * entry seen longest ago, so the table stays bounded and keeps roughly
+ * the most recent keys.
+ */
+
+#define RATE_LIMITER_KEY_WAYS 8
+
+struct key_entry {
+	uint32_t hash;
+	uint8_t key_class;
+	uint8_t len;
+	bool used;
+	char name[RATE_LIMITER_KEY_MAX];
+	uint64_t window_start;          /* Nanoseconds the current window began */
+	uint64_t last_seen;
+	uint32_t previous;              /* Events in the window before */
+	uint32_t current;               /* Events in the current window */
+	unsigned long allowed;
+	unsigned long denied;
+};
+
+struct key_set {
+	pthread_mutex_t mutex;
+	struct key_entry ways[RATE_LIMITER_KEY_WAYS];
+};
+
+struct key_table {
+	struct key_set *sets;
+	size_t set_mask;
+};
+
+/* Limit of one key class, a window of 0 leaves its keys unlimited */
+struct key_limit {
+	_Atomic uint64_t window_ns;
+	_Atomic uint32_t limit;         /* Events per window */
+};
+
+/* Per-event-type rate limiter map
+ *
+ * Entries are only ever added, at the head of their bucket, and are
+ * complete before they are published, so lookups walk the chains without
+ * the mutex. Setting the limit of a known event type reconfigures its
+ * limiter in place rather than replacing it. The global limiter and the
+ * key table are published the same way.
+ */
 
 #define RATE_LIMITER_MAP_SIZE 256
 
@@ -248,13 +354,178 @@ struct rate_limiter_entry {
 };
 
 struct rate_limiter_map {
-	struct rate_limiter_entry *buckets[RATE_LIMITER_MAP_SIZE];
-	struct rate_limiter *default_limiter;
-	pthread_mutex_t mutex;
+	_Atomic(struct rate_limiter_entry *) buckets[RATE_LIMITER_MAP_SIZE];
+	struct rate_limiter *default_limiter; /* NULL if unspecified types are unlimited */
+	_Atomic(struct rate_limiter *) global_limiter;
+	_Atomic(struct key_table *) keys;
+	struct key_limit key_limits[RATE_LIMITER_KEY_CLASSES];
+	size_t key_capacity;
+	pthread_mutex_t mutex;          /* Serializes configuration changes */
 	double default_rate;
 	size_t default_burst;
 };
 
+/* FNV-1a over the class and the name */
+static uint32_t key_hash(uint8_t key_class, const char *name, size_t len)
+{
+	uint32_t hash = (2166136261u ^ key_class) * 16777619u;
+	
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
+	
+	return hash;
+}
+
+static struct key_table *key_table_create(size_t entries)
+{
+	struct key_table *table;
+	size_t sets = 1;
+	
+	while (sets * RATE_LIMITER_KEY_WAYS < entries)
+		sets *= 2;
+	
+	table = calloc(1, sizeof(*table));
+	if (!table)
+		return NULL;
+	
+	table->sets = calloc(sets, sizeof(*table->sets));
+	if (!table->sets) {
+		free(table);
+		return NULL;
+	}
+	table->set_mask = sets - 1;
+	
+	for (size_t i = 0; i < sets; i++)
+		pthread_mutex_init(&table->sets[i].mutex, NULL);
+	
+	return table;
+}
+
+static void key_table_destroy(struct key_table *table)
+{
+	if (!table)
+		return;
+	
+	for (size_t i = 0; i <= table->set_mask; i++)
+		pthread_mutex_destroy(&table->sets[i].mutex);
+	free(table->sets);
+	free(table);
+}
+
+/* Entry of key in set, called with the set's mutex held */
+static struct key_entry *key_find(struct key_set *set, uint32_t hash, uint8_t key_class,
+                                  const char *name, size_t len)
+{
+	for (size_t i = 0; i < RATE_LIMITER_KEY_WAYS; i++) {
+		struct key_entry *entry = &set->ways[i];
+		
+		if (entry->used && entry->hash == hash && entry->key_class == key_class &&
+		    entry->len == len && memcmp(entry->name, name, len) == 0)
+			return entry;
+	}
+	
+	return NULL;
+}
+
+/* Replace the least recently seen entry of set with key */
+static struct key_entry *key_claim(struct key_set *set, uint32_t hash, uint8_t key_class,
+                                   const char *name, size_t len, uint64_t now)
+{
+	struct key_entry *entry = &set->ways[0];
+	
+	for (size_t i = 1; i < RATE_LIMITER_KEY_WAYS && entry->used; i++) {
+		if (!set->ways[i].used || set->ways[i].last_seen < entry->last_seen)
+			entry = &set->ways[i];
+	}
+	
+	memset(entry, 0, sizeof(*entry));
+	entry->used = true;
+	entry->hash = hash;
+	entry->key_class = key_class;
+	entry->len = (uint8_t)len;
+	memcpy(entry->name, name, len);
+	entry->window_start = now;
+	return entry;
+}
+
+/* Count events in the key's windows, 1 if counted, 0 if unlimited, -1 if denied */
+static int key_take(struct rate_limiter_map *map, struct key_table *table,
+                    const struct rate_limiter_key *key)
+{
+	struct key_limit *limit;
+	struct key_entry *entry;
+	struct key_set *set;
+	uint64_t window, now, elapsed;
+	size_t len;
+	uint32_t hash;
+	double estimate;
+	int ret = 1;
+	
+	if ((unsigned int)key->key_class >= RATE_LIMITER_KEY_CLASSES)
+		return 0;
+	
+	limit = &map->key_limits[key->key_class];
+	window = atomic_load_explicit(&limit->window_ns, memory_order_relaxed);
+	if (!window)
+		return 0;
+	
+	len = key->len < RATE_LIMITER_KEY_MAX ? key->len : RATE_LIMITER_KEY_MAX;
+	hash = key_hash(key->key_class, key->name, len);
+	set = &table->sets[hash & table->set_mask];
+	
+	pthread_mutex_lock(&set->mutex);
+	
+	now = get_time_ns();
+	entry = key_find(set, hash, key->key_class, key->name, len);
+	if (!entry)
+		entry = key_claim(set, hash, key->key_class, key->name, len, now);
+	
+	/* Move on to the window now falls in */
+	elapsed = now - entry->window_start;
+	if (elapsed >= window) {
+		entry->previous = elapsed < 2 * window ? entry->current : 0;
+		entry->current = 0;
+		entry->window_start = now - elapsed % window;
+		elapsed %= window;
+	}
+	entry->last_seen = now;
+	
+	estimate = entry->previous * ((double)(window - elapsed) / window) + entry->current;
+	if (estimate + 1 > atomic_load_explicit(&limit->limit, memory_order_relaxed)) {
+		entry->denied++;
+		ret = -1;
+	} else {
+		entry->current++;
+		entry->allowed++;
+	}
+	
+	pthread_mutex_unlock(&set->mutex);
+	return ret;
+}
+
+/* Undo a key_take() that counted the event */
+static void key_refund(struct key_table *table, const struct rate_limiter_key *key)
+{
+	struct key_entry *entry;
+	struct key_set *set;
+	size_t len;
+	uint32_t hash;
+	
+	len = key->len < RATE_LIMITER_KEY_MAX ? key->len : RATE_LIMITER_KEY_MAX;
+	hash = key_hash(key->key_class, key->name, len);
+	set = &table->sets[hash & table->set_mask];
+	
+	pthread_mutex_lock(&set->mutex);
+	entry = key_find(set, hash, key->key_class, key->name, len);
+	if (entry && entry->current > 0) {
+		entry->current--;
+		entry->allowed--;
+	}
+	pthread_mutex_unlock(&set->mutex);
+}
+
 static uint32_t hash_event_type(uint32_t event_type)
 {
 	/* Simple hash function */
@@ -266,6 +537,28 @@ static uint32_t hash_event_type(uint32_t event_type)
 	return event_type % RATE_LIMITER_MAP_SIZE;
 }
 
+static struct rate_limiter_entry *map_find(struct rate_limiter_map *map, uint32_t event_type)
+{
+	struct rate_limiter_entry *entry;
+	
+	entry = atomic_load_explicit(&map->buckets[hash_event_type(event_type)],
+	                             memory_order_acquire);
+	for (; entry; entry = entry->next) {
+		if (entry->event_type == event_type)
+			return entry;
+	}
+	
+	return NULL;
+}
+
+/* Limiter for event type, the default one if none is set */
+static struct rate_limiter *map_limiter(struct rate_limiter_map *map, uint32_t event_type)
+{
+	struct rate_limiter_entry *entry = map_find(map, event_type);
+	
+	return entry ? entry->limiter : map->default_limiter;
+}
+
 struct rate_limiter_map *rate_limiter_map_create(double default_rate,
                                                   size_t default_burst)
 {
@@ -277,11 +570,14 @@ struct rate_limiter_map *rate_limiter_map_create(double default_rate,
 	
 	map->default_rate = default_rate;
 	map->default_burst = default_burst;
+	map->key_capacity = RATE_LIMITER_KEY_ENTRIES;
 	
-	map->default_limiter = rate_limiter_create(default_rate, default_burst);
-	if (!map->default_limiter) {
-		free(map);
-		return NULL;
+	if (default_rate != 0) {
+		map->default_limiter = rate_limiter_create(default_rate, default_burst);
+		if (!map->default_limiter) {
+			free(map);
+			return NULL;
+		}
 	}
 	
 	if (pthread_mutex_init(&map->mutex, NULL) != 0) {
@@ -302,7 +598,7 @@ void rate_limiter_map_destroy(struct rate_limiter_map *map)
 		return;
 	
 	for (i = 0; i < RATE_LIMITER_MAP_SIZE; i++) {
-		entry = map->buckets[i];
+		entry = atomic_load_explicit(&map->buckets[i], memory_order_relaxed);
 		while (entry) {
 			next = entry->next;
 			rate_limiter_destroy(entry->limiter);
@@ -312,6 +608,8 @@ void rate_limiter_map_destroy(struct rate_limiter_map *map)
 	}
 	
 	rate_limiter_destroy(map->default_limiter);
+	rate_limiter_destroy(atomic_load_explicit(&map->global_limiter, memory_order_relaxed));
+	key_table_destroy(atomic_load_explicit(&map->keys, memory_order_relaxed));
 	pthread_mutex_destroy(&map->mutex);
 	free(map);
 }
@@ -323,80 +621,185 @@ bool rate_limiter_map_set(struct rate_limiter_map *map, uint32_t event_type,
 	struct rate_limiter *limiter;
 	uint32_t bucket;
 	
-	if (!map)
-		return false;
-	
-	limiter = rate_limiter_create(rate, burst);
-	if (!limiter)
+	if (!map || rate <= 0 || burst == 0)
 		return false;
 	
 	bucket = hash_event_type(event_type);
 	
 	pthread_mutex_lock(&map->mutex);
 	
-	/* Check if entry exists */
-	for (entry = map->buckets[bucket]; entry; entry = entry->next) {
-		if (entry->event_type == event_type) {
-			/* Update existing */
-			rate_limiter_destroy(entry->limiter);
-			entry->limiter = limiter;
-			pthread_mutex_unlock(&map->mutex);
-			return true;
-		}
+	/* Update existing, lookups may be using its limiter */
+	entry = map_find(map, event_type);
+	if (entry) {
+		limiter_reconfigure(entry->limiter, rate, burst);
+		pthread_mutex_unlock(&map->mutex);
+		return true;
 	}
 	
 	/* Create new entry */
 	entry = malloc(sizeof(*entry));
-	if (!entry) {
+	limiter = rate_limiter_create(rate, burst);
+	if (!entry || !limiter) {
 		rate_limiter_destroy(limiter);
+		free(entry);
 		pthread_mutex_unlock(&map->mutex);
 		return false;
 	}
 	
 	entry->event_type = event_type;
 	entry->limiter = limiter;
-	entry->next = map->buckets[bucket];
-	map->buckets[bucket] = entry;
+	entry->next = atomic_load_explicit(&map->buckets[bucket], memory_order_relaxed);
+	atomic_store_explicit(&map->buckets[bucket], entry, memory_order_release);
 	
 	pthread_mutex_unlock(&map->mutex);
 	return true;
 }
 
-bool rate_limiter_map_allow(struct rate_limiter_map *map, uint32_t event_type)
+bool rate_limiter_map_set_global(struct rate_limiter_map *map, double rate, size_t burst)
 {
-	struct rate_limiter_entry *entry;
-	struct rate_limiter *limiter = NULL;
-	uint32_t bucket;
-	bool allowed;
+	struct rate_limiter *limiter;
 	
-	if (!map)
-		return true;
+	if (!map || rate <= 0 || burst == 0)
+		return false;
 	
-	bucket = hash_event_type(event_type);
+	pthread_mutex_lock(&map->mutex);
+	
+	limiter = atomic_load_explicit(&map->global_limiter, memory_order_relaxed);
+	if (limiter) {
+		limiter_reconfigure(limiter, rate, burst);
+	} else {
+		limiter = rate_limiter_create(rate, burst);
+		if (!limiter) {
+			pthread_mutex_unlock(&map->mutex);
+			return false;
+		}
+		atomic_store_explicit(&map->global_limiter, limiter, memory_order_release);
+	}
+	
+	pthread_mutex_unlock(&map->mutex);
+	return true;
+}
+
+bool rate_limiter_map_set_key_capacity(struct rate_limiter_map *map, size_t entries)
+{
+	bool ok;
+	
+	if (!map || entries == 0)
+		return false;
 	
 	pthread_mutex_lock(&map->mutex);
+	ok = !atomic_load_explicit(&map->keys, memory_order_relaxed);
+	if (ok)
+		map->key_capacity = entries;
+	pthread_mutex_unlock(&map->mutex);
 	
-	/* Find limiter for event type */
-	for (entry = map->buckets[bucket]; entry; entry = entry->next) {
-		if (entry->event_type == event_type) {
-			limiter = entry->limiter;
-			break;
+	return ok;
+}
+
+bool rate_limiter_map_set_key_limit(struct rate_limiter_map *map,
+                                    enum rate_limiter_key_class key_class,
+                                    double rate, size_t burst)
+{
+	struct key_limit *limit;
+	struct key_table *table;
+	
+	if (!map || (unsigned int)key_class >= RATE_LIMITER_KEY_CLASSES || rate < 0)
+		return false;
+	if (rate > 0 && burst == 0)
+		return false;
+	
+	limit = &map->key_limits[key_class];
+	
+	pthread_mutex_lock(&map->mutex);
+	
+	if (rate == 0) {
+		atomic_store_explicit(&limit->window_ns, 0, memory_order_relaxed);
+		pthread_mutex_unlock(&map->mutex);
+		return true;
+	}
+	
+	table = atomic_load_explicit(&map->keys, memory_order_relaxed);
+	if (!table) {
+		table = key_table_create(map->key_capacity);
+		if (!table) {
+			pthread_mutex_unlock(&map->mutex);
+			return false;
 		}
+		atomic_store_explicit(&map->keys, table, memory_order_release);
 	}
 	
-	/* Use default if not found */
-	if (!limiter)
-		limiter = map->default_limiter;
+	/* A check racing with this may pair the old window with the new limit */
+	atomic_store_explicit(&limit->limit, burst < UINT32_MAX ? (uint32_t)burst : UINT32_MAX,
+	                      memory_order_relaxed);
+	atomic_store_explicit(&limit->window_ns, (uint64_t)(burst / rate * 1000000000.0),
+	                      memory_order_relaxed);
 	
 	pthread_mutex_unlock(&map->mutex);
+	return true;
+}
+
+bool rate_limiter_map_allow(struct rate_limiter_map *map, uint32_t event_type)
+{
+	return rate_limiter_map_allow_keys(map, event_type, NULL, 0);
+}
+
+bool rate_limiter_map_allow_keys(struct rate_limiter_map *map, uint32_t event_type,
+                                 const struct rate_limiter_key *keys, size_t count)
+{
+	struct rate_limiter *limiter, *global;
+	struct key_table *table;
+	uint32_t counted = 0;
+	size_t i;
+	int ret;
+	
+	if (!map)
+		return true;
 	
-	allowed = rate_limiter_allow(limiter);
-	return allowed;
+	if (count > RATE_LIMITER_MAX_KEYS)
+		count = RATE_LIMITER_MAX_KEYS;
+	
+	table = atomic_load_explicit(&map->keys, memory_order_acquire);
+	for (i = 0; table && i < count; i++) {
+		ret = key_take(map, table, &keys[i]);
+		if (ret < 0)
+			goto denied;
+		if (ret > 0)
+			counted |= 1u << i;
+	}
+	
+	limiter = map_limiter(map, event_type);
+	if (limiter && !take_tokens(limiter, 1)) {
+		count_events(limiter, 1, false);
+		goto denied;
+	}
+	
+	global = atomic_load_explicit(&map->global_limiter, memory_order_acquire);
+	if (global && !take_tokens(global, 1)) {
+		count_events(global, 1, false);
+		if (limiter)
+			give_tokens(limiter, 1);
+		goto denied;
+	}
+	
+	if (limiter)
+		count_events(limiter, 1, true);
+	if (global)
+		count_events(global, 1, true);
+	return true;
+	
+denied:
+	/* The levels before did not keep the event from anyone */
+	for (i = 0; i < count; i++) {
+		if (counted & (1u << i))
+			key_refund(table, &keys[i]);
+	}
+	return false;
 }
 
 void rate_limiter_map_reset(struct rate_limiter_map *map)
 {
 	struct rate_limiter_entry *entry;
+	struct key_table *table;
 	size_t i;
 	
 	if (!map)
@@ -405,12 +808,24 @@ void rate_limiter_map_reset(struct rate_limiter_map *map)
 	pthread_mutex_lock(&map->mutex);
 	
 	rate_limiter_reset(map->default_limiter);
+	rate_limiter_reset(atomic_load_explicit(&map->global_limiter, memory_order_relaxed));
 	
 	for (i = 0; i < RATE_LIMITER_MAP_SIZE; i++) {
-		for (entry = map->buckets[i]; entry; entry = entry->next)
+		entry = atomic_load_explicit(&map->buckets[i], memory_order_relaxed);
+		for (; entry; entry = entry->next)
 			rate_limiter_reset(entry->limiter);
 	}
 	
+	table = atomic_load_explicit(&map->keys, memory_order_relaxed);
+	for (i = 0; table && i <= table->set_mask; i++) {
+		struct key_set *set = &table->sets[i];
+		
+		pthread_mutex_lock(&set->mutex);
+		for (size_t j = 0; j < RATE_LIMITER_KEY_WAYS; j++)
+			set->ways[j].used = false;
+		pthread_mutex_unlock(&set->mutex);
+	}
+	
 	pthread_mutex_unlock(&map->mutex);
 }
 
@@ -419,30 +834,71 @@ void rate_limiter_map_stats(struct rate_limiter_map *map, uint32_t event_type,
                             unsigned long *denied,
                             double *current_rate)
 {
-	struct rate_limiter_entry *entry;
-	struct rate_limiter *limiter = NULL;
-	uint32_t bucket;
-	
 	if (!map)
 		return;
 	
-	bucket = hash_event_type(event_type);
+	/* Nothing counts events of types without a limit */
+	if (allowed)
+		*allowed = 0;
+	if (denied)
+		*denied = 0;
+	if (current_rate)
+		*current_rate = 0;
 	
-	pthread_mutex_lock(&map->mutex);
+	rate_limiter_stats(map_limiter(map, event_type), allowed, denied, current_rate);
+}
+
+/* Whether key a was denied more often than b, then allowed more often */
+static bool key_stats_before(const struct key_entry *a, const struct rate_limiter_key_stats *b)
+{
+	if (a->denied != b->denied)
+		return a->denied > b->denied;
+	return a->allowed > b->allowed;
+}
+
+size_t rate_limiter_map_top_keys(struct rate_limiter_map *map,
+                                 struct rate_limiter_key_stats *stats, size_t max)
+{
+	struct key_table *table;
+	size_t count = 0;
 	
-	/* Find limiter for event type */
-	for (entry = map->buckets[bucket]; entry; entry = entry->next) {
-		if (entry->event_type == event_type) {
-			limiter = entry->limiter;
-			break;
-		}
-	}
+	if (!map || !stats || max == 0)
+		return 0;
 	
-	/* Use default if not found */
-	if (!limiter)
-		limiter = map->default_limiter;
+	table = atomic_load_explicit(&map->keys, memory_order_acquire);
+	if (!table)
+		return 0;
 	
-	pthread_mutex_unlock(&map->mutex);
+	for (size_t i = 0; i <= table->set_mask; i++) {
+		struct key_set *set = &table->sets[i];
+		
+		pthread_mutex_lock(&set->mutex);
+		
+		for (size_t j = 0; j < RATE_LIMITER_KEY_WAYS; j++) {
+			const struct key_entry *entry = &set->ways[j];
+			size_t pos = count;
+			
+			if (!entry->used)
+				continue;
+			
+			/* Insert into the sorted output, dropping its last entry if full */
+			while (pos > 0 && key_stats_before(entry, &stats[pos - 1]))
+				pos--;
+			if (pos == max)
+				continue;
+			if (count < max)
+				count++;
+			memmove(&stats[pos + 1], &stats[pos], (count - 1 - pos) * sizeof(*stats));
+			
+			stats[pos].key_class = entry->key_class;
+			memcpy(stats[pos].name, entry->name, entry->len);
+			stats[pos].name[entry->len] = '\0';
+			stats[pos].allowed = entry->allowed;
+			stats[pos].denied = entry->denied;
+		}
+		
+		pthread_mutex_unlock(&set->mutex);
+	}
 	
-	rate_limiter_stats(limiter, allowed, denied, current_rate);
+	return count;
 }
@@ -1,27 +1,71 @@
-/* resource_tracker.c - System resource monitoring and metrics collection */
+/* resource_tracker.c - System resource monitoring and metrics collection
+ *
+ * Metrics take slots in order and keep them for the life of the tracker,
+ * so a slot is a stable handle. Name and labels are looked up through an
+ * open addressed hash index that is only written under the lock, when a
+ * metric is registered, and read without it. Updating a metric by handle
+ * takes no lock: counters add to one of RT_SHARDS arrays picked per
+ * thread so that threads do not share cache lines, gauges store the bits
+ * of their value, and histograms record into an HDR histogram and atomic
+ * bucket counters kept beside the metric. The value fields of struct
+ * metric are filled in from them, summing the shards, whenever a metric
+ * is read.
+ *
+ * With cardinality limits set, registering a label set past a name's
+ * max_series returns the name's overflow slot, and listing or exporting
+ * first has the governor pick the series to show from their progress
+ * since the last read. Folded series are added into a copy of the
+ * overflow metric, so slots and handles are never given up.
+ */
 
 #include "resource_tracker.h"
+#include "hdr_histogram.h"
+#include "cardinality_governor.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdatomic.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <math.h>
 
 #define DEFAULT_MAX_METRICS 1024
 #define HISTOGRAM_BUCKETS 10
+#define RT_SHARDS 16
+#define RT_CACHE_LINE 64
+
+/* Names of the gauges reporting cardinality, never governed themselves */
+#define GOVERNANCE_PREFIX "nlmon_metric_series"
 
 /* Predefined histogram bucket boundaries */
-static const double histogram_boundaries[HISTOGRAM_BUCKETS] = {
+const double metric_histogram_bounds[HISTOGRAM_BUCKETS] = {
 	0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1.0, 5.0, 10.0, +INFINITY
 };
 
+/* Recording state of a histogram metric */
+struct histogram_state {
+	struct hdr_histogram *hdr;
+	_Atomic uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
 struct resource_tracker {
 	struct metric *metrics;
+	struct histogram_state **histograms;    /* By metric slot, NULL if not one */
+	_Atomic uint64_t *gauges;               /* Bits of gauge values, by slot */
+	_Atomic uint64_t *shards[RT_SHARDS];    /* Counter additions, by slot */
+	_Atomic int *index;                     /* Hash of name and labels to slot + 1 */
+	size_t index_mask;
 	size_t max_metrics;
-	size_t num_metrics;
+	_Atomic size_t num_metrics;             /* Slots below are in use */
+	int histogram_schema;
 	pthread_mutex_t lock;
 	
+	/* Cardinality limits, the per slot state used under the lock */
+	struct cardinality_governor *governor;
+	struct cardinality_series *activity;
+	struct cardinality_series **selection;
+	bool *grouped;
+	
 	/* Cached system metrics */
 	struct resource_stats cached_stats;
 	time_t last_system_update;
@@ -42,154 +86,422 @@ struct resource_tracker {
 	uint64_t processing_samples;
 };
 
+/* Counter shard of the calling thread plus one, 0 until first use */
+static __thread unsigned int thread_shard;
+static _Atomic unsigned int next_shard;
+
+static inline unsigned int current_shard(void)
+{
+	if (thread_shard == 0)
+		thread_shard = atomic_fetch_add_explicit(&next_shard, 1, memory_order_relaxed) %
+		               RT_SHARDS + 1;
+	return thread_shard - 1;
+}
+
+static inline uint64_t double_bits(double value)
+{
+	uint64_t bits;
+	
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static inline double bits_double(uint64_t bits)
+{
+	double value;
+	
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static uint64_t monotonic_ms(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static inline bool is_governance(const char *name)
+{
+	return strncmp(name, GOVERNANCE_PREFIX, sizeof(GOVERNANCE_PREFIX) - 1) == 0;
+}
+
+static inline bool is_overflow(const char *labels)
+{
+	return labels && strcmp(labels, CARDINALITY_OVERFLOW_LABELS) == 0;
+}
+
+/* FNV-1a over what create_metric() keeps of a string */
+static uint32_t hash_string(uint32_t hash, const char *s, size_t max)
+{
+	for (size_t i = 0; i < max && s[i]; i++) {
+		hash ^= (unsigned char)s[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static uint32_t hash_key(const char *name, const char *labels)
+{
+	uint32_t hash = hash_string(2166136261u, name, sizeof(((struct metric *)0)->name) - 1);
+	
+	hash ^= 0xff;   /* Separates "ab","c" from "a","bc" */
+	hash *= 16777619u;
+	return hash_string(hash, labels, sizeof(((struct metric *)0)->labels) - 1);
+}
+
 struct resource_tracker *resource_tracker_create(size_t max_metrics)
 {
 	struct resource_tracker *tracker;
+	size_t index_size = 1;
+	size_t shard_size;
+	int i;
 	
 	if (max_metrics == 0)
 		max_metrics = DEFAULT_MAX_METRICS;
+	if (max_metrics > INT32_MAX / 4)
+		return NULL;
 	
 	tracker = calloc(1, sizeof(*tracker));
 	if (!tracker)
 		return NULL;
 	
 	tracker->metrics = calloc(max_metrics, sizeof(struct metric));
-	if (!tracker->metrics) {
-		free(tracker);
-		return NULL;
+	if (!tracker->metrics)
+		goto err_free;
+	
+	tracker->histograms = calloc(max_metrics, sizeof(*tracker->histograms));
+	if (!tracker->histograms)
+		goto err_metrics;
+	
+	tracker->gauges = calloc(max_metrics, sizeof(*tracker->gauges));
+	if (!tracker->gauges)
+		goto err_histograms;
+	
+	/* Whole cache lines, so no two shards share one */
+	shard_size = (max_metrics * sizeof(uint64_t) + RT_CACHE_LINE - 1) &
+	             ~(size_t)(RT_CACHE_LINE - 1);
+	for (i = 0; i < RT_SHARDS; i++) {
+		tracker->shards[i] = aligned_alloc(RT_CACHE_LINE, shard_size);
+		if (!tracker->shards[i])
+			goto err_shards;
+		memset(tracker->shards[i], 0, shard_size);
 	}
 	
+	/* At most half full, so probes stay short and always end */
+	while (index_size < max_metrics * 2)
+		index_size <<= 1;
+	tracker->index = calloc(index_size, sizeof(*tracker->index));
+	if (!tracker->index)
+		goto err_shards;
+	tracker->index_mask = index_size - 1;
+	
+	tracker->governor = cardinality_governor_create();
+	tracker->activity = calloc(max_metrics, sizeof(*tracker->activity));
+	tracker->selection = calloc(max_metrics, sizeof(*tracker->selection));
+	tracker->grouped = calloc(max_metrics, sizeof(*tracker->grouped));
+	if (!tracker->governor || !tracker->activity || !tracker->selection || !tracker->grouped)
+		goto err_governor;
+	
 	tracker->max_metrics = max_metrics;
-	tracker->num_metrics = 0;
+	atomic_init(&tracker->num_metrics, 0);
+	tracker->histogram_schema = HDR_HISTOGRAM_DEFAULT_SCHEMA;
 	pthread_mutex_init(&tracker->lock, NULL);
 	
 	tracker->tracking_start_time = time(NULL);
 	tracker->last_system_update = 0;
 	
 	return tracker;
+	
+err_governor:
+	free(tracker->grouped);
+	free(tracker->selection);
+	free(tracker->activity);
+	cardinality_governor_destroy(tracker->governor);
+	free(tracker->index);
+err_shards:
+	for (i = 0; i < RT_SHARDS; i++)
+		free(tracker->shards[i]);
+	free(tracker->gauges);
+err_histograms:
+	free(tracker->histograms);
+err_metrics:
+	free(tracker->metrics);
+err_free:
+	free(tracker);
+	return NULL;
 }
 
 void resource_tracker_destroy(struct resource_tracker *tracker)
 {
+	size_t i;
+	
 	if (!tracker)
 		return;
 	
+	for (i = 0; i < tracker->max_metrics; i++) {
+		if (tracker->histograms[i]) {
+			hdr_histogram_destroy(tracker->histograms[i]->hdr);
+			free(tracker->histograms[i]);
+		}
+	}
+	
 	pthread_mutex_destroy(&tracker->lock);
+	free(tracker->grouped);
+	free(tracker->selection);
+	free(tracker->activity);
+	cardinality_governor_destroy(tracker->governor);
+	free(tracker->index);
+	for (i = 0; i < RT_SHARDS; i++)
+		free(tracker->shards[i]);
+	free(tracker->gauges);
+	free(tracker->histograms);
 	free(tracker->metrics);
 	free(tracker);
 }
 
-static struct metric *find_metric(struct resource_tracker *tracker,
-                                  const char *name,
-                                  const char *labels)
+/* Slot of a metric or -1, safe without the lock */
+static int find_metric(struct resource_tracker *tracker,
+                       const char *name,
+                       const char *labels)
 {
-	size_t i;
 	const char *label_str = labels ? labels : "";
+	size_t i = hash_key(name, label_str) & tracker->index_mask;
 	
-	for (i = 0; i < tracker->max_metrics; i++) {
-		if (tracker->metrics[i].in_use &&
-		    strcmp(tracker->metrics[i].name, name) == 0 &&
-		    strcmp(tracker->metrics[i].labels, label_str) == 0) {
-			return &tracker->metrics[i];
-		}
+	for (;; i = (i + 1) & tracker->index_mask) {
+		int slot = atomic_load_explicit(&tracker->index[i], memory_order_acquire);
+		struct metric *m;
+		
+		if (slot == 0)
+			return -1;
+		
+		m = &tracker->metrics[slot - 1];
+		if (strncmp(m->name, name, sizeof(m->name) - 1) == 0 &&
+		    strncmp(m->labels, label_str, sizeof(m->labels) - 1) == 0)
+			return slot - 1;
 	}
-	
-	return NULL;
 }
 
-static struct metric *create_metric(struct resource_tracker *tracker,
-                                    const char *name,
-                                    const char *labels,
-                                    enum metric_type type)
+/* Take the next slot for a metric, lock held */
+static int create_metric(struct resource_tracker *tracker,
+                         const char *name,
+                         const char *labels,
+                         enum metric_type type)
 {
-	size_t i;
-	struct metric *m;
+	size_t slot = atomic_load_explicit(&tracker->num_metrics, memory_order_relaxed);
 	const char *label_str = labels ? labels : "";
+	struct metric *m;
+	size_t i;
 	
-	/* Find free slot */
-	for (i = 0; i < tracker->max_metrics; i++) {
-		if (!tracker->metrics[i].in_use) {
-			m = &tracker->metrics[i];
-			
-			strncpy(m->name, name, sizeof(m->name) - 1);
-			m->name[sizeof(m->name) - 1] = '\0';
-			
-			strncpy(m->labels, label_str, sizeof(m->labels) - 1);
-			m->labels[sizeof(m->labels) - 1] = '\0';
-			
-			m->type = type;
-			memset(&m->value, 0, sizeof(m->value));
-			
-			if (type == METRIC_HISTOGRAM) {
-				m->value.histogram.min = INFINITY;
-				m->value.histogram.max = -INFINITY;
-			}
-			
-			m->last_updated = time(NULL);
-			m->in_use = true;
-			
-			tracker->num_metrics++;
-			return m;
+	if (slot >= tracker->max_metrics)
+		return -1;
+	
+	m = &tracker->metrics[slot];
+	
+	strncpy(m->name, name, sizeof(m->name) - 1);
+	m->name[sizeof(m->name) - 1] = '\0';
+	
+	strncpy(m->labels, label_str, sizeof(m->labels) - 1);
+	m->labels[sizeof(m->labels) - 1] = '\0';
+	
+	if (type == METRIC_HISTOGRAM) {
+		struct histogram_state *hs = calloc(1, sizeof(*hs));
+		
+		if (!hs)
+			return -1;
+		
+		hs->hdr = hdr_histogram_create(tracker->histogram_schema);
+		if (!hs->hdr) {
+			free(hs);
+			return -1;
 		}
+		tracker->histograms[slot] = hs;
 	}
 	
-	return NULL;
+	m->type = type;
+	memset(&m->value, 0, sizeof(m->value));
+	
+	if (type == METRIC_HISTOGRAM) {
+		m->value.histogram.min = INFINITY;
+		m->value.histogram.max = -INFINITY;
+	}
+	atomic_store_explicit(&tracker->gauges[slot], double_bits(0.0), memory_order_relaxed);
+	
+	m->last_updated = time(NULL);
+	m->in_use = true;
+	cardinality_series_init(&tracker->activity[slot], monotonic_ms());
+	
+	/* Published only once filled in, lookups and updates go unlocked */
+	for (i = hash_key(m->name, m->labels) & tracker->index_mask;
+	     atomic_load_explicit(&tracker->index[i], memory_order_relaxed) != 0;
+	     i = (i + 1) & tracker->index_mask)
+		;
+	atomic_store_explicit(&tracker->index[i], (int)slot + 1, memory_order_release);
+	atomic_store_explicit(&tracker->num_metrics, slot + 1, memory_order_release);
+	
+	return (int)slot;
 }
 
-bool resource_tracker_counter_inc(struct resource_tracker *tracker,
-                                  const char *name,
-                                  const char *labels,
-                                  uint64_t value)
+/* Metric behind a handle if it is of the given type, safe without the lock */
+static struct metric *handle_metric(struct resource_tracker *tracker, int metric,
+                                    enum metric_type type)
 {
 	struct metric *m;
-	bool success = false;
 	
-	if (!tracker || !name)
-		return false;
+	if (!tracker || metric < 0 ||
+	    (size_t)metric >= atomic_load_explicit(&tracker->num_metrics, memory_order_acquire))
+		return NULL;
 	
-	pthread_mutex_lock(&tracker->lock);
+	m = &tracker->metrics[metric];
+	return m->type == type ? m : NULL;
+}
+
+/* Fill in the value fields of m from its recording state, lock held */
+static void sync_metric(struct resource_tracker *tracker, struct metric *m)
+{
+	size_t slot = m - tracker->metrics;
+	struct histogram_state *hs = tracker->histograms[slot];
+	union metric_value old = m->value;
+	bool changed = false;
+	uint64_t sum = 0;
+	int i;
 	
-	m = find_metric(tracker, name, labels);
-	if (!m)
-		m = create_metric(tracker, name, labels, METRIC_COUNTER);
+	switch (m->type) {
+	case METRIC_COUNTER:
+		for (i = 0; i < RT_SHARDS; i++)
+			sum += atomic_load_explicit(&tracker->shards[i][slot], memory_order_relaxed);
+		m->value.counter = sum;
+		changed = sum != old.counter;
+		break;
+		
+	case METRIC_GAUGE:
+		m->value.gauge = bits_double(atomic_load_explicit(&tracker->gauges[slot],
+		                                                  memory_order_relaxed));
+		changed = double_bits(m->value.gauge) != double_bits(old.gauge);
+		break;
+		
+	case METRIC_HISTOGRAM:
+		if (!hs)
+			return;
+		m->value.histogram.count = hdr_histogram_count(hs->hdr);
+		m->value.histogram.sum = hdr_histogram_sum(hs->hdr);
+		m->value.histogram.min = hdr_histogram_min(hs->hdr);
+		m->value.histogram.max = hdr_histogram_max(hs->hdr);
+		for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+			m->value.histogram.buckets[i] = atomic_load_explicit(&hs->buckets[i],
+			                                                     memory_order_relaxed);
+		changed = m->value.histogram.count != old.histogram.count;
+		break;
+	}
 	
-	if (m && m->type == METRIC_COUNTER) {
-		m->value.counter += value;
+	/* Updates do not stamp the metric, keeping them to one atomic */
+	if (changed)
 		m->last_updated = time(NULL);
-		success = true;
+}
+
+int resource_tracker_register(struct resource_tracker *tracker,
+                              const char *name,
+                              const char *labels,
+                              enum metric_type type)
+{
+	int metric;
+	
+	if (!tracker || !name)
+		return -1;
+	
+	metric = find_metric(tracker, name, labels);
+	if (metric < 0) {
+		pthread_mutex_lock(&tracker->lock);
+		
+		/* Another thread may have registered it meanwhile */
+		metric = find_metric(tracker, name, labels);
+		if (metric < 0 && !is_governance(name) && !is_overflow(labels) &&
+		    !cardinality_governor_admit(tracker->governor, name)) {
+			metric = find_metric(tracker, name, CARDINALITY_OVERFLOW_LABELS);
+			if (metric < 0)
+				metric = create_metric(tracker, name, CARDINALITY_OVERFLOW_LABELS, type);
+		} else if (metric < 0) {
+			metric = create_metric(tracker, name, labels, type);
+		}
+		
+		pthread_mutex_unlock(&tracker->lock);
 	}
 	
-	pthread_mutex_unlock(&tracker->lock);
+	if (metric >= 0 && tracker->metrics[metric].type != type)
+		return -1;
 	
-	return success;
+	return metric;
 }
 
-bool resource_tracker_gauge_set(struct resource_tracker *tracker,
-                                const char *name,
-                                const char *labels,
-                                double value)
+bool resource_tracker_set_cardinality(struct resource_tracker *tracker,
+                                      const char *name,
+                                      const struct cardinality_limits *limits)
 {
-	struct metric *m;
-	bool success = false;
+	if (!tracker)
+		return false;
 	
-	if (!tracker || !name)
+	return cardinality_governor_set_limits(tracker->governor, name, limits);
+}
+
+bool resource_tracker_counter_add(struct resource_tracker *tracker, int metric, uint64_t value)
+{
+	if (!handle_metric(tracker, metric, METRIC_COUNTER))
 		return false;
 	
-	pthread_mutex_lock(&tracker->lock);
+	atomic_fetch_add_explicit(&tracker->shards[current_shard()][metric], value,
+	                          memory_order_relaxed);
+	return true;
+}
+
+bool resource_tracker_gauge_update(struct resource_tracker *tracker, int metric, double value)
+{
+	if (!handle_metric(tracker, metric, METRIC_GAUGE))
+		return false;
 	
-	m = find_metric(tracker, name, labels);
-	if (!m)
-		m = create_metric(tracker, name, labels, METRIC_GAUGE);
+	atomic_store_explicit(&tracker->gauges[metric], double_bits(value), memory_order_relaxed);
+	return true;
+}
+
+bool resource_tracker_histogram_record(struct resource_tracker *tracker, int metric, double value)
+{
+	struct histogram_state *hs;
+	int i;
 	
-	if (m && m->type == METRIC_GAUGE) {
-		m->value.gauge = value;
-		m->last_updated = time(NULL);
-		success = true;
-	}
+	if (!handle_metric(tracker, metric, METRIC_HISTOGRAM))
+		return false;
 	
-	pthread_mutex_unlock(&tracker->lock);
+	/* Histogram state lives as long as the tracker */
+	hs = tracker->histograms[metric];
+	hdr_histogram_record(hs->hdr, value);
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		if (value <= metric_histogram_bounds[i])
+			atomic_fetch_add_explicit(&hs->buckets[i], 1, memory_order_relaxed);
+	}
 	
-	return success;
+	return true;
+}
+
+bool resource_tracker_counter_inc(struct resource_tracker *tracker,
+                                  const char *name,
+                                  const char *labels,
+                                  uint64_t value)
+{
+	return resource_tracker_counter_add(tracker,
+	                                    resource_tracker_register(tracker, name, labels,
+	                                                              METRIC_COUNTER),
+	                                    value);
+}
+
+bool resource_tracker_gauge_set(struct resource_tracker *tracker,
+                                const char *name,
+                                const char *labels,
+                                double value)
+{
+	return resource_tracker_gauge_update(tracker,
+	                                     resource_tracker_register(tracker, name, labels,
+	                                                               METRIC_GAUGE),
+	                                     value);
 }
 
 bool resource_tracker_histogram_observe(struct resource_tracker *tracker,
@@ -197,42 +509,41 @@ bool resource_tracker_histogram_observe(struct resource_tracker *tracker,
                                         const char *labels,
                                         double value)
 {
-	struct metric *m;
-	bool success = false;
-	int i;
+	return resource_tracker_histogram_record(tracker,
+	                                         resource_tracker_register(tracker, name, labels,
+	                                                                   METRIC_HISTOGRAM),
+	                                         value);
+}
+
+bool resource_tracker_histogram_quantile(struct resource_tracker *tracker,
+                                         const char *name,
+                                         const char *labels,
+                                         double quantile,
+                                         double *value)
+{
+	int metric;
 	
-	if (!tracker || !name)
+	if (!tracker || !name || !value)
 		return false;
 	
-	pthread_mutex_lock(&tracker->lock);
-	
-	m = find_metric(tracker, name, labels);
-	if (!m)
-		m = create_metric(tracker, name, labels, METRIC_HISTOGRAM);
+	metric = find_metric(tracker, name, labels);
+	if (!handle_metric(tracker, metric, METRIC_HISTOGRAM))
+		return false;
 	
-	if (m && m->type == METRIC_HISTOGRAM) {
-		m->value.histogram.sum += value;
-		m->value.histogram.count++;
-		
-		if (value < m->value.histogram.min)
-			m->value.histogram.min = value;
-		if (value > m->value.histogram.max)
-			m->value.histogram.max = value;
-		
-		/* Update histogram buckets */
-		for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
-			if (value <= histogram_boundaries[i]) {
-				m->value.histogram.buckets[i]++;
-			}
-		}
-		
-		m->last_updated = time(NULL);
-		success = true;
-	}
+	*value = hdr_histogram_quantile(tracker->histograms[metric]->hdr, quantile);
+	return true;
+}
+
+bool resource_tracker_set_histogram_schema(struct resource_tracker *tracker, int schema)
+{
+	if (!tracker || schema < HDR_HISTOGRAM_MIN_SCHEMA || schema > HDR_HISTOGRAM_MAX_SCHEMA)
+		return false;
 	
+	pthread_mutex_lock(&tracker->lock);
+	tracker->histogram_schema = schema;
 	pthread_mutex_unlock(&tracker->lock);
 	
-	return success;
+	return true;
 }
 
 bool resource_tracker_get_metric(struct resource_tracker *tracker,
@@ -242,25 +553,27 @@ bool resource_tracker_get_metric(struct resource_tracker *tracker,
                                  union metric_value *value)
 {
 	struct metric *m;
-	bool found = false;
+	int metric;
 	
 	if (!tracker || !name)
 		return false;
 	
+	metric = find_metric(tracker, name, labels);
+	if (metric < 0)
+		return false;
+	
 	pthread_mutex_lock(&tracker->lock);
 	
-	m = find_metric(tracker, name, labels);
-	if (m) {
-		if (type)
-			*type = m->type;
-		if (value)
-			*value = m->value;
-		found = true;
-	}
+	m = &tracker->metrics[metric];
+	sync_metric(tracker, m);
+	if (type)
+		*type = m->type;
+	if (value)
+		*value = m->value;
 	
 	pthread_mutex_unlock(&tracker->lock);
 	
-	return found;
+	return true;
 }
 
 void resource_tracker_update_system_metrics(struct resource_tracker *tracker)
@@ -268,6 +581,7 @@ void resource_tracker_update_system_metrics(struct resource_tracker *tracker)
 	FILE *fp;
 	char line[512];
 	uint64_t utime, stime;
+	int cpu_gauge, rss_gauge, vms_gauge, peak_gauge;
 	time_t now;
 	
 	if (!tracker)
@@ -279,6 +593,13 @@ void resource_tracker_update_system_metrics(struct resource_tracker *tracker)
 	if (now == tracker->last_system_update)
 		return;
 	
+	/* Registering takes the lock, so it is done first */
+	cpu_gauge = resource_tracker_register(tracker, "nlmon_cpu_usage_percent", NULL, METRIC_GAUGE);
+	rss_gauge = resource_tracker_register(tracker, "nlmon_memory_rss_bytes", NULL, METRIC_GAUGE);
+	vms_gauge = resource_tracker_register(tracker, "nlmon_memory_vms_bytes", NULL, METRIC_GAUGE);
+	peak_gauge = resource_tracker_register(tracker, "nlmon_memory_peak_rss_bytes", NULL,
+	                                       METRIC_GAUGE);
+	
 	pthread_mutex_lock(&tracker->lock);
 	
 	/* Read CPU usage from /proc/self/stat */
@@ -301,8 +622,7 @@ void resource_tracker_update_system_metrics(struct resource_tracker *tracker)
 						tracker->cached_stats.cpu_usage_percent = cpu_percent;
 						
 						/* Update gauge metric */
-						resource_tracker_gauge_set(tracker, "nlmon_cpu_usage_percent",
-						                          NULL, cpu_percent);
+						resource_tracker_gauge_update(tracker, cpu_gauge, cpu_percent);
 					}
 				}
 				
@@ -324,16 +644,13 @@ void resource_tracker_update_system_metrics(struct resource_tracker *tracker)
 			
 			if (sscanf(line, "VmRSS: %lu kB", &value) == 1) {
 				tracker->cached_stats.memory_rss_bytes = value * 1024;
-				resource_tracker_gauge_set(tracker, "nlmon_memory_rss_bytes",
-				                          NULL, value * 1024);
+				resource_tracker_gauge_update(tracker, rss_gauge, value * 1024);
 			} else if (sscanf(line, "VmSize: %lu kB", &value) == 1) {
 				tracker->cached_stats.memory_vms_bytes = value * 1024;
-				resource_tracker_gauge_set(tracker, "nlmon_memory_vms_bytes",
-				                          NULL, value * 1024);
+				resource_tracker_gauge_update(tracker, vms_gauge, value * 1024);
 			} else if (sscanf(line, "VmPeak: %lu kB", &value) == 1) {
 				tracker->cached_stats.memory_peak_rss_bytes = value * 1024;
-				resource_tracker_gauge_set(tracker, "nlmon_memory_peak_rss_bytes",
-				                          NULL, value * 1024);
+				resource_tracker_gauge_update(tracker, peak_gauge, value * 1024);
 			}
 		}
 		fclose(fp);
@@ -385,19 +702,35 @@ bool resource_tracker_reset_metric(struct resource_tracker *tracker,
 {
 	struct metric *m;
 	bool found = false;
+	int metric;
 	
 	if (!tracker || !name)
 		return false;
 	
+	metric = find_metric(tracker, name, labels);
+	
 	pthread_mutex_lock(&tracker->lock);
 	
-	m = find_metric(tracker, name, labels);
-	if (m) {
+	if (metric >= 0) {
+		struct histogram_state *hs = tracker->histograms[metric];
+		size_t i;
+		
+		m = &tracker->metrics[metric];
 		memset(&m->value, 0, sizeof(m->value));
+		
+		/* Additions racing with the reset may survive it */
+		for (i = 0; i < RT_SHARDS; i++)
+			atomic_store_explicit(&tracker->shards[i][metric], 0, memory_order_relaxed);
+		atomic_store_explicit(&tracker->gauges[metric], double_bits(0.0), memory_order_relaxed);
 		if (m->type == METRIC_HISTOGRAM) {
 			m->value.histogram.min = INFINITY;
 			m->value.histogram.max = -INFINITY;
 		}
+		if (hs) {
+			hdr_histogram_reset(hs->hdr);
+			for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+				atomic_store_explicit(&hs->buckets[i], 0, memory_order_relaxed);
+		}
 		m->last_updated = time(NULL);
 		found = true;
 	}
@@ -407,21 +740,165 @@ bool resource_tracker_reset_metric(struct resource_tracker *tracker,
 	return found;
 }
 
+/* Set a gauge reporting cardinality, lock held */
+static void set_governance_gauge(struct resource_tracker *tracker, const char *name,
+                                 const char *labels, uint64_t value)
+{
+	int slot = find_metric(tracker, name, labels);
+	
+	if (slot < 0)
+		slot = create_metric(tracker, name, labels, METRIC_GAUGE);
+	if (slot >= 0 && tracker->metrics[slot].type == METRIC_GAUGE)
+		atomic_store_explicit(&tracker->gauges[slot], double_bits((double)value),
+		                      memory_order_relaxed);
+}
+
+static void publish_cardinality(const struct cardinality_stats *stats, void *ctx)
+{
+	struct resource_tracker *tracker = ctx;
+	char labels[sizeof(((struct metric *)0)->labels)];
+	
+	snprintf(labels, sizeof(labels), "metric=\"%s\"", stats->name);
+	set_governance_gauge(tracker, GOVERNANCE_PREFIX, labels, stats->series);
+	set_governance_gauge(tracker, GOVERNANCE_PREFIX "_collapsed", labels, stats->rejected);
+	set_governance_gauge(tracker, GOVERNANCE_PREFIX "_folded", labels, stats->folded);
+	set_governance_gauge(tracker, GOVERNANCE_PREFIX "_expired", labels, stats->expired);
+}
+
+/* Progress the governor compares metrics by, value fields synced */
+static uint64_t metric_progress(const struct metric *m)
+{
+	switch (m->type) {
+	case METRIC_COUNTER:
+		return m->value.counter;
+	case METRIC_GAUGE:
+		return double_bits(m->value.gauge);
+	case METRIC_HISTOGRAM:
+		return m->value.histogram.count;
+	}
+	return 0;
+}
+
+/*
+ * Decide per slot whether a read shows, folds or leaves the metric out,
+ * lock held. Returns false without limits, when every metric is shown.
+ */
+static bool govern_metrics(struct resource_tracker *tracker)
+{
+	size_t count, i, j, n;
+	bool has_overflow;
+	uint64_t now;
+	
+	if (!cardinality_governor_active(tracker->governor))
+		return false;
+	
+	now = monotonic_ms();
+	count = atomic_load_explicit(&tracker->num_metrics, memory_order_relaxed);
+	memset(tracker->grouped, 0, count * sizeof(*tracker->grouped));
+	
+	for (i = 0; i < count; i++) {
+		struct metric *m = &tracker->metrics[i];
+		
+		if (tracker->grouped[i] || is_governance(m->name))
+			continue;
+		
+		n = 0;
+		has_overflow = false;
+		for (j = i; j < count; j++) {
+			struct metric *other = &tracker->metrics[j];
+			
+			if (tracker->grouped[j] || strcmp(other->name, m->name) != 0)
+				continue;
+			
+			tracker->grouped[j] = true;
+			if (is_overflow(other->labels)) {
+				has_overflow = true;
+				continue;
+			}
+			
+			sync_metric(tracker, other);
+			cardinality_series_update(&tracker->activity[j], metric_progress(other),
+			                          other->type != METRIC_GAUGE, now);
+			tracker->selection[n++] = &tracker->activity[j];
+		}
+		
+		/* Shown from the next read, when there is a slot left for it */
+		if (cardinality_governor_select(tracker->governor, m->name, tracker->selection, n,
+		                                now) && !has_overflow)
+			create_metric(tracker, m->name, CARDINALITY_OVERFLOW_LABELS, m->type);
+	}
+	
+	cardinality_governor_for_each(tracker->governor, publish_cardinality, tracker);
+	return true;
+}
+
+/* Metric as a governed read shows it, NULL if folded or left out, lock held */
+static const struct metric *governed_metric(struct resource_tracker *tracker, size_t slot,
+                                            struct metric *overflow)
+{
+	const struct metric *m = &tracker->metrics[slot];
+	size_t count, i, j;
+	
+	if (tracker->activity[slot].verdict != CARDINALITY_SHOW)
+		return NULL;
+	if (!is_overflow(m->labels))
+		return m;
+	
+	*overflow = *m;
+	count = atomic_load_explicit(&tracker->num_metrics, memory_order_relaxed);
+	for (i = 0; i < count; i++) {
+		const struct metric *f = &tracker->metrics[i];
+		
+		if (tracker->activity[i].verdict != CARDINALITY_FOLD || f->type != m->type ||
+		    strcmp(f->name, m->name) != 0)
+			continue;
+		
+		switch (f->type) {
+		case METRIC_COUNTER:
+			overflow->value.counter += f->value.counter;
+			break;
+		case METRIC_GAUGE:
+			overflow->value.gauge += f->value.gauge;
+			break;
+		case METRIC_HISTOGRAM:
+			overflow->value.histogram.count += f->value.histogram.count;
+			overflow->value.histogram.sum += f->value.histogram.sum;
+			overflow->value.histogram.min = fmin(overflow->value.histogram.min,
+			                                     f->value.histogram.min);
+			overflow->value.histogram.max = fmax(overflow->value.histogram.max,
+			                                     f->value.histogram.max);
+			for (j = 0; j < HISTOGRAM_BUCKETS; j++)
+				overflow->value.histogram.buckets[j] += f->value.histogram.buckets[j];
+			break;
+		}
+		if (f->last_updated > overflow->last_updated)
+			overflow->last_updated = f->last_updated;
+	}
+	
+	return overflow;
+}
+
 void resource_tracker_list_metrics(struct resource_tracker *tracker,
                                    void (*callback)(const struct metric *, void *),
                                    void *user_data)
 {
-	size_t i;
+	const struct metric *m;
+	struct metric overflow;
+	size_t i, count;
+	bool governed;
 	
 	if (!tracker || !callback)
 		return;
 	
 	pthread_mutex_lock(&tracker->lock);
 	
-	for (i = 0; i < tracker->max_metrics; i++) {
-		if (tracker->metrics[i].in_use) {
-			callback(&tracker->metrics[i], user_data);
-		}
+	governed = govern_metrics(tracker);
+	count = atomic_load_explicit(&tracker->num_metrics, memory_order_relaxed);
+	for (i = 0; i < count; i++) {
+		sync_metric(tracker, &tracker->metrics[i]);
+		m = governed ? governed_metric(tracker, i, &overflow) : &tracker->metrics[i];
+		if (m)
+			callback(m, user_data);
 	}
 	
 	pthread_mutex_unlock(&tracker->lock);
@@ -431,18 +908,24 @@ ssize_t resource_tracker_export_prometheus(struct resource_tracker *tracker,
                                            char *buffer,
                                            size_t buffer_size)
 {
+	struct metric overflow;
 	size_t offset = 0;
-	size_t i, j;
+	size_t i, j, count;
+	bool governed;
 	
 	if (!tracker || !buffer || buffer_size == 0)
 		return -1;
 	
 	pthread_mutex_lock(&tracker->lock);
 	
-	for (i = 0; i < tracker->max_metrics && offset < buffer_size - 512; i++) {
-		struct metric *m = &tracker->metrics[i];
+	/* Counters are summed over their shards here */
+	governed = govern_metrics(tracker);
+	count = atomic_load_explicit(&tracker->num_metrics, memory_order_relaxed);
+	for (i = 0; i < count && offset < buffer_size - 512; i++) {
+		const struct metric *m = &tracker->metrics[i];
 		
-		if (!m->in_use)
+		sync_metric(tracker, &tracker->metrics[i]);
+		if (governed && !(m = governed_metric(tracker, i, &overflow)))
 			continue;
 		
 		switch (m->type) {
@@ -489,7 +972,7 @@ ssize_t resource_tracker_export_prometheus(struct resource_tracker *tracker,
 					snprintf(le_str, sizeof(le_str), "+Inf");
 				} else {
 					snprintf(le_str, sizeof(le_str), "%.3f",
-					        histogram_boundaries[j]);
+					        metric_histogram_bounds[j]);
 				}
 				
 				if (m->labels[0]) {
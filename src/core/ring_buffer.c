@@ -2,12 +2,21 @@
  *
  * Single-producer, single-consumer lock-free ring buffer using atomic operations.
  * Provides high-performance event queuing with overflow handling and backpressure.
+ *
+ * The MPMC variant is a bounded queue with a sequence number per slot:
+ * a slot at position pos is free for the producer of pos when its
+ * sequence equals pos and holds an item for the consumer of pos when it
+ * equals pos + 1. Producers and consumers claim runs of positions with
+ * one CAS on head or tail.
+ *
+ * Slot arrays of large rings are huge page backed, see huge_alloc.h.
  */
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdatomic.h>
 #include "ring_buffer.h"
+#include "huge_alloc.h"
 
 /* Round up to next power of 2 */
 static size_t next_power_of_2(size_t n)
@@ -28,9 +37,10 @@ static size_t next_power_of_2(size_t n)
 	return n;
 }
 
-struct ring_buffer *ring_buffer_create(size_t capacity)
+static struct ring_buffer *ring_buffer_alloc(size_t capacity, bool mpmc)
 {
 	struct ring_buffer *rb;
+	size_t i;
 	
 	if (capacity == 0)
 		return NULL;
@@ -42,12 +52,24 @@ struct ring_buffer *ring_buffer_create(size_t capacity)
 	/* Round capacity to next power of 2 for fast modulo */
 	rb->capacity = next_power_of_2(capacity);
 	rb->mask = rb->capacity - 1;
+	rb->mpmc = mpmc;
 	
 	/* Allocate data array */
-	rb->data = calloc(rb->capacity, sizeof(void *));
-	if (!rb->data) {
-		free(rb);
-		return NULL;
+	if (mpmc) {
+		rb->slots = huge_calloc(rb->capacity, sizeof(*rb->slots), 0, "ring_buffer");
+		if (!rb->slots) {
+			free(rb);
+			return NULL;
+		}
+		
+		for (i = 0; i < rb->capacity; i++)
+			atomic_init(&rb->slots[i].sequence, i);
+	} else {
+		rb->data = huge_calloc(rb->capacity, sizeof(void *), 0, "ring_buffer");
+		if (!rb->data) {
+			free(rb);
+			return NULL;
+		}
 	}
 	
 	/* Initialize atomics */
@@ -61,15 +83,137 @@ struct ring_buffer *ring_buffer_create(size_t capacity)
 	return rb;
 }
 
+struct ring_buffer *ring_buffer_create(size_t capacity)
+{
+	return ring_buffer_alloc(capacity, false);
+}
+
+struct ring_buffer *ring_buffer_create_mpmc(size_t capacity)
+{
+	/* The sequence scheme needs at least two slots */
+	return ring_buffer_alloc(capacity < 2 ? 2 : capacity, true);
+}
+
 void ring_buffer_destroy(struct ring_buffer *rb)
 {
 	if (!rb)
 		return;
 	
-	free(rb->data);
+	huge_free(rb->data);
+	huge_free(rb->slots);
 	free(rb);
 }
 
+static void ring_buffer_update_peak(struct ring_buffer *rb, size_t size)
+{
+	unsigned long current_peak = atomic_load_explicit(&rb->peak_usage, memory_order_relaxed);
+	
+	while (size > current_peak) {
+		if (atomic_compare_exchange_weak_explicit(&rb->peak_usage, &current_peak, size,
+		                                          memory_order_relaxed, memory_order_relaxed))
+			break;
+	}
+}
+
+static size_t mpmc_size(struct ring_buffer *rb)
+{
+	/* Tail first, it never passes head */
+	size_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+	size_t head = atomic_load_explicit(&rb->head, memory_order_acquire);
+	size_t size = head - tail;
+	
+	return size > rb->capacity ? rb->capacity : size;
+}
+
+static size_t mpmc_enqueue(struct ring_buffer *rb, void *const *items, size_t count)
+{
+	struct ring_buffer_slot *slot;
+	size_t pos, cur, n, i;
+	
+	pos = atomic_load_explicit(&rb->head, memory_order_relaxed);
+	for (;;) {
+		/* Free slots from pos onwards, a free slot stays free until claimed */
+		for (n = 0; n < count; n++) {
+			slot = &rb->slots[(pos + n) & rb->mask];
+			if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != pos + n)
+				break;
+		}
+		
+		if (n == 0) {
+			/* Full, unless another producer moved head meanwhile */
+			cur = atomic_load_explicit(&rb->head, memory_order_relaxed);
+			if (cur == pos)
+				break;
+			pos = cur;
+			continue;
+		}
+		
+		if (atomic_compare_exchange_weak_explicit(&rb->head, &pos, pos + n,
+		                                          memory_order_relaxed,
+		                                          memory_order_relaxed))
+			break;
+	}
+	
+	/* Publish the claimed slots to consumers */
+	for (i = 0; i < n; i++) {
+		slot = &rb->slots[(pos + i) & rb->mask];
+		slot->item = items[i];
+		atomic_store_explicit(&slot->sequence, pos + i + 1, memory_order_release);
+	}
+	
+	/* Update statistics */
+	if (n)
+		atomic_fetch_add_explicit(&rb->enqueue_count, n, memory_order_relaxed);
+	if (n < count)
+		atomic_fetch_add_explicit(&rb->overflow_count, count - n, memory_order_relaxed);
+	ring_buffer_update_peak(rb, mpmc_size(rb));
+	
+	return n;
+}
+
+static size_t mpmc_dequeue(struct ring_buffer *rb, void **items, size_t max)
+{
+	struct ring_buffer_slot *slot;
+	size_t pos, cur, n, i;
+	
+	pos = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+	for (;;) {
+		/* Filled slots from pos onwards */
+		for (n = 0; n < max; n++) {
+			slot = &rb->slots[(pos + n) & rb->mask];
+			if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != pos + n + 1)
+				break;
+		}
+		
+		if (n == 0) {
+			/* Empty, unless another consumer moved tail meanwhile */
+			cur = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+			if (cur == pos)
+				return 0;
+			pos = cur;
+			continue;
+		}
+		
+		if (atomic_compare_exchange_weak_explicit(&rb->tail, &pos, pos + n,
+		                                          memory_order_relaxed,
+		                                          memory_order_relaxed))
+			break;
+	}
+	
+	/* Take the items and hand the slots to the next lap's producers */
+	for (i = 0; i < n; i++) {
+		slot = &rb->slots[(pos + i) & rb->mask];
+		items[i] = slot->item;
+		atomic_store_explicit(&slot->sequence, pos + i + rb->capacity,
+		                      memory_order_release);
+	}
+	
+	/* Update statistics */
+	atomic_fetch_add_explicit(&rb->dequeue_count, n, memory_order_relaxed);
+	
+	return n;
+}
+
 bool ring_buffer_enqueue(struct ring_buffer *rb, void *item)
 {
 	size_t head, tail, next_head, size;
@@ -77,6 +221,9 @@ bool ring_buffer_enqueue(struct ring_buffer *rb, void *item)
 	if (!rb || !item)
 		return false;
 	
+	if (rb->mpmc)
+		return mpmc_enqueue(rb, &item, 1) == 1;
+	
 	/* Load current positions with acquire semantics */
 	head = atomic_load_explicit(&rb->head, memory_order_acquire);
 	tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
@@ -102,17 +249,47 @@ bool ring_buffer_enqueue(struct ring_buffer *rb, void *item)
 	/* Update peak usage */
 	size = (head >= tail) ? (head - tail) : (rb->capacity - tail + head);
 	size++;  /* Include the item we just added */
-	
-	unsigned long current_peak = atomic_load_explicit(&rb->peak_usage, memory_order_relaxed);
-	while (size > current_peak) {
-		if (atomic_compare_exchange_weak_explicit(&rb->peak_usage, &current_peak, size,
-		                                          memory_order_relaxed, memory_order_relaxed))
-			break;
-	}
+	ring_buffer_update_peak(rb, size);
 	
 	return true;
 }
 
+size_t ring_buffer_enqueue_bulk(struct ring_buffer *rb, void *const *items, size_t count)
+{
+	size_t head, tail, space, n, i;
+	
+	if (!rb || !items || count == 0)
+		return 0;
+	
+	if (rb->mpmc)
+		return mpmc_enqueue(rb, items, count);
+	
+	/* Load current positions with acquire semantics */
+	head = atomic_load_explicit(&rb->head, memory_order_acquire);
+	tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+	
+	/* One slot stays empty to tell full from empty */
+	space = rb->mask - ((head - tail) & rb->mask);
+	n = count < space ? count : space;
+	
+	/* Store items */
+	for (i = 0; i < n; i++)
+		rb->data[(head + i) & rb->mask] = items[i];
+	
+	/* Publish all items with one head update */
+	if (n)
+		atomic_store_explicit(&rb->head, (head + n) & rb->mask, memory_order_release);
+	
+	/* Update statistics */
+	if (n)
+		atomic_fetch_add_explicit(&rb->enqueue_count, n, memory_order_relaxed);
+	if (n < count)
+		atomic_fetch_add_explicit(&rb->overflow_count, count - n, memory_order_relaxed);
+	ring_buffer_update_peak(rb, ((head - tail) & rb->mask) + n);
+	
+	return n;
+}
+
 void *ring_buffer_dequeue(struct ring_buffer *rb)
 {
 	size_t head, tail, next_tail;
@@ -121,6 +298,9 @@ void *ring_buffer_dequeue(struct ring_buffer *rb)
 	if (!rb)
 		return NULL;
 	
+	if (rb->mpmc)
+		return mpmc_dequeue(rb, &item, 1) ? item : NULL;
+	
 	/* Load current positions with acquire semantics */
 	head = atomic_load_explicit(&rb->head, memory_order_acquire);
 	tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
@@ -144,6 +324,39 @@ void *ring_buffer_dequeue(struct ring_buffer *rb)
 	return item;
 }
 
+size_t ring_buffer_dequeue_bulk(struct ring_buffer *rb, void **items, size_t max)
+{
+	size_t head, tail, count, i;
+	
+	if (!rb || !items || max == 0)
+		return 0;
+	
+	if (rb->mpmc)
+		return mpmc_dequeue(rb, items, max);
+	
+	/* Load current positions with acquire semantics */
+	head = atomic_load_explicit(&rb->head, memory_order_acquire);
+	tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+	
+	count = (head - tail) & rb->mask;
+	if (count > max)
+		count = max;
+	if (count == 0)
+		return 0;
+	
+	/* Get items */
+	for (i = 0; i < count; i++)
+		items[i] = rb->data[(tail + i) & rb->mask];
+	
+	/* Release all slots with one tail update */
+	atomic_store_explicit(&rb->tail, (tail + count) & rb->mask, memory_order_release);
+	
+	/* Update statistics */
+	atomic_fetch_add_explicit(&rb->dequeue_count, count, memory_order_relaxed);
+	
+	return count;
+}
+
 bool ring_buffer_is_empty(struct ring_buffer *rb)
 {
 	size_t head, tail;
@@ -151,6 +364,9 @@ bool ring_buffer_is_empty(struct ring_buffer *rb)
 	if (!rb)
 		return true;
 	
+	if (rb->mpmc)
+		return mpmc_size(rb) == 0;
+	
 	head = atomic_load_explicit(&rb->head, memory_order_acquire);
 	tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
 	
@@ -164,6 +380,9 @@ bool ring_buffer_is_full(struct ring_buffer *rb)
 	if (!rb)
 		return false;
 	
+	if (rb->mpmc)
+		return mpmc_size(rb) >= rb->capacity;
+	
 	head = atomic_load_explicit(&rb->head, memory_order_acquire);
 	tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
 	
@@ -179,6 +398,9 @@ size_t ring_buffer_size(struct ring_buffer *rb)
 	if (!rb)
 		return 0;
 	
+	if (rb->mpmc)
+		return mpmc_size(rb);
+	
 	head = atomic_load_explicit(&rb->head, memory_order_acquire);
 	tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
 	
@@ -193,6 +415,9 @@ size_t ring_buffer_capacity(struct ring_buffer *rb)
 	if (!rb)
 		return 0;
 	
+	if (rb->mpmc)
+		return rb->capacity;
+	
 	return rb->capacity - 1;  /* One slot is reserved for full/empty detection */
 }
 
@@ -2,42 +2,97 @@
  *
  * Implements detection of suspicious network activities including
  * promiscuous mode, ARP floods, route hijacking, and interface anomalies.
+ *
+ * Flood and storm state is kept in fixed memory: rates in window
+ * counters, link events per interface in a count-min sketch and the
+ * distinct neighbors of the most recently active interfaces in
+ * HyperLogLogs, so an attacker cycling through addresses or interface
+ * names cannot grow it.
+ *
+ * Route hijacks are judged against a mirror of the routing tables kept
+ * from route events, so a route is compared with the one it replaces and
+ * with the routes covering its prefix. Neighbor and conntrack events are
+ * applied to mirrors of the current entries the same way, and a neighbor
+ * is judged against the link-layer address it was known by.
+ *
+ * Detectors register the message types they handle in a table, and an
+ * event runs only the enabled detectors found under its type. Per
+ * interface state is split in shards by interface name, each with its own
+ * lock, so events of different interfaces are judged concurrently when
+ * several workers feed the detector.
  */
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <time.h>
 #include <pthread.h>
 #include <stdatomic.h>
 #include <sys/time.h>
+#include <linux/netlink.h>
 #include <linux/rtnetlink.h>
-#include <linux/if.h>
+#include <linux/neighbour.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+#include <net/if.h>
 #include "security_detector.h"
 #include "event_processor.h"
+#include "nlmon_nl_route.h"
+#include "window_counter.h"
+#include "sketch.h"
+#include "nlmon_clock.h"
+#include "fib_mirror.h"
+#include "state_mirror.h"
+
+/* Counters per row of the interface storm sketch, overcounts stay below
+ * the storm threshold up to tens of thousands of interfaces per window */
+#define STORM_SKETCH_WIDTH 4096
+
+/* Interfaces whose distinct neighbors are counted */
+#define NEIGHBOR_TRACKERS 64
+
+/* Shards of the per interface state, a power of two */
+#define DETECTOR_SHARDS 8
+
+/* Message types dispatched by event->message_type, rtnetlink ones fit */
+#define DISPATCH_ROUTE_TYPES 128
 
-/* Time window entry for rate tracking */
-struct time_window_entry {
-	time_t timestamp;
+/* Dispatch slots, ctnetlink message types follow the rtnetlink ones */
+#define DISPATCH_TYPES (DISPATCH_ROUTE_TYPES + IPCTNL_MSG_MAX)
+
+/* Message types a detector can register */
+#define DETECTOR_MAX_TYPES 4
+
+/* Detectors the table can hold */
+#define DETECTORS_MAX 16
+
+/* Distinct neighbors of an interface in the current ARP window */
+struct neighbor_tracker {
 	char interface[16];
-	struct time_window_entry *next;
+	bool used;
+	bool alerted;                   /* Reported in this window */
+	time_t last_seen;
+	struct hyperloglog addresses;
 };
 
-/* Interface tracking for storm detection */
-struct interface_tracker {
-	char interface[16];
-	size_t event_count;
-	time_t window_start;
-	struct interface_tracker *next;
+/* Interface state of the interfaces hashed to one shard */
+struct detector_shard {
+	pthread_mutex_t mutex;
+	
+	/* Distinct neighbors, ARP flood tracking */
+	struct neighbor_tracker neighbors[NEIGHBOR_TRACKERS / DETECTOR_SHARDS];
+	time_t neighbor_epoch;          /* Window the trackers count */
+	
+	/* Link events, interface storm tracking */
+	struct count_min *storm_sketch;
+	time_t storm_epoch;             /* Window the sketch counts */
 };
 
-/* Route tracking for hijack detection */
-struct route_entry {
-	uint32_t dst;
-	uint32_t gateway;
-	char interface[16];
-	time_t timestamp;
-	struct route_entry *next;
+/* Detectors run for one message type, indexes into the detector table */
+struct dispatch_slot {
+	uint8_t count;
+	uint8_t detectors[DETECTORS_MAX];
 };
 
 /* Security event callback entry */
@@ -52,22 +107,28 @@ struct callback_entry {
 struct security_detector {
 	struct security_detector_config config;
 	
-	/* ARP flood tracking */
-	struct time_window_entry *arp_window;
+	/* Enabled detectors by message type */
+	struct dispatch_slot dispatch[DISPATCH_TYPES];
+	
+	/* ARP flood rate of all interfaces */
+	struct window_counter *arp_window;
 	pthread_mutex_t arp_mutex;
 	
-	/* Neighbor flood tracking */
-	struct time_window_entry *neighbor_window;
+	/* Neighbor flood rate of all interfaces */
+	struct window_counter *neighbor_window;
 	pthread_mutex_t neighbor_mutex;
 	
-	/* Interface storm tracking */
-	struct interface_tracker *interface_trackers;
-	pthread_mutex_t interface_mutex;
+	/* Per interface state */
+	struct detector_shard shards[DETECTOR_SHARDS];
 	
-	/* Route tracking */
-	struct route_entry *routes;
+	/* Mirror of the routing tables, checked and updated as one step */
+	struct fib_mirror *fib;
 	pthread_mutex_t route_mutex;
 	
+	/* Current neighbors and flows, locked by the mirrors */
+	struct neigh_mirror *neigh_mirror;
+	struct ct_mirror *ct_mirror;
+	
 	/* Callbacks */
 	struct callback_entry *callbacks;
 	pthread_mutex_t callback_mutex;
@@ -81,14 +142,9 @@ struct security_detector {
 	atomic_ulong route_hijack_events;
 	atomic_ulong neighbor_flood_events;
 	atomic_ulong interface_storm_events;
+	atomic_ulong neighbor_spoof_events;
 };
 
-/* Get current time */
-static time_t get_current_time(void)
-{
-	return time(NULL);
-}
-
 /* Emit security event to all callbacks */
 static void emit_security_event(struct security_detector *sd,
                                 struct security_event *event)
@@ -105,76 +161,12 @@ static void emit_security_event(struct security_detector *sd,
 	atomic_fetch_add_explicit(&sd->security_events, 1, memory_order_relaxed);
 }
 
-/* Clean old entries from time window */
-static void clean_time_window(struct time_window_entry **head,
-                              time_t cutoff_time)
-{
-	struct time_window_entry *entry, *prev, *next;
-	
-	prev = NULL;
-	entry = *head;
-	
-	while (entry) {
-		next = entry->next;
-		
-		if (entry->timestamp < cutoff_time) {
-			if (prev)
-				prev->next = next;
-			else
-				*head = next;
-			free(entry);
-		} else {
-			prev = entry;
-		}
-		
-		entry = next;
-	}
-}
-
-/* Count entries in time window */
-static size_t count_time_window(struct time_window_entry *head)
-{
-	size_t count = 0;
-	struct time_window_entry *entry;
-	
-	for (entry = head; entry; entry = entry->next)
-		count++;
-	
-	return count;
-}
-
-/* Add entry to time window */
-static bool add_time_window_entry(struct time_window_entry **head,
-                                  const char *interface)
-{
-	struct time_window_entry *entry;
-	
-	entry = malloc(sizeof(*entry));
-	if (!entry)
-		return false;
-	
-	entry->timestamp = get_current_time();
-	strncpy(entry->interface, interface, sizeof(entry->interface) - 1);
-	entry->interface[sizeof(entry->interface) - 1] = '\0';
-	entry->next = *head;
-	*head = entry;
-	
-	return true;
-}
-
 /* Detect promiscuous mode */
 static bool detect_promiscuous_mode(struct security_detector *sd,
                                     struct nlmon_event *event)
 {
 	struct security_event sec_event;
 	
-	if (!sd->config.enable_promisc_detection)
-		return false;
-	
-	/* Check if this is a link change event with IFF_PROMISC flag */
-	if (event->message_type != RTM_NEWLINK)
-		return false;
-	
 	/* We would need to parse the netlink message to check IFF_PROMISC flag
 	 * For now, we'll use a simplified check based on event data */
 	if (event->data && event->data_size >= sizeof(uint32_t)) {
@@ -184,7 +176,7 @@ static bool detect_promiscuous_mode(struct security_detector *sd,
 			memset(&sec_event, 0, sizeof(sec_event));
 			sec_event.type = SECURITY_PROMISCUOUS_MODE;
 			sec_event.severity = SECURITY_HIGH;
-			sec_event.timestamp = get_current_time();
+			sec_event.timestamp = nlmon_clock_seconds();
 			strncpy(sec_event.interface, event->interface,
 			        sizeof(sec_event.interface) - 1);
 			snprintf(sec_event.description, sizeof(sec_event.description),
@@ -201,52 +193,136 @@ static bool detect_promiscuous_mode(struct security_detector *sd,
 	return false;
 }
 
+/* Hash of an interface name, picks its shard and its storm counter */
+static uint64_t interface_hash(const char *interface)
+{
+	return sketch_hash(interface, strnlen(interface, IFNAMSIZ), 0);
+}
+
+/* Shard of an interface, from bits the storm sketch does not index by */
+static struct detector_shard *interface_shard(struct security_detector *sd, uint64_t hash)
+{
+	return &sd->shards[(hash >> 56) & (DETECTOR_SHARDS - 1)];
+}
+
+/* Tracker of interface for the window at now, called with the shard locked */
+static struct neighbor_tracker *neighbor_tracker(struct security_detector *sd,
+                                                 struct detector_shard *shard,
+                                                 const char *interface, time_t now)
+{
+	struct neighbor_tracker *tracker, *victim = &shard->neighbors[0];
+	time_t epoch = now / (time_t)sd->config.arp_time_window;
+	size_t i;
+	
+	/* A new window starts every interface from zero */
+	if (epoch != shard->neighbor_epoch) {
+		for (i = 0; i < NEIGHBOR_TRACKERS / DETECTOR_SHARDS; i++) {
+			hyperloglog_reset(&shard->neighbors[i].addresses);
+			shard->neighbors[i].alerted = false;
+		}
+		shard->neighbor_epoch = epoch;
+	}
+	
+	for (i = 0; i < NEIGHBOR_TRACKERS / DETECTOR_SHARDS; i++) {
+		tracker = &shard->neighbors[i];
+		if (tracker->used &&
+		    strncmp(tracker->interface, interface, sizeof(tracker->interface)) == 0) {
+			tracker->last_seen = now;
+			return tracker;
+		}
+		if (victim->used && (!tracker->used || tracker->last_seen < victim->last_seen))
+			victim = tracker;
+	}
+	
+	/* Replace the interface seen longest ago */
+	memset(victim, 0, sizeof(*victim));
+	victim->used = true;
+	strncpy(victim->interface, interface, sizeof(victim->interface) - 1);
+	victim->last_seen = now;
+	return victim;
+}
+
+/* Count the neighbor of event, returns the distinct neighbors if newly above threshold */
+static double count_distinct_neighbor(struct security_detector *sd,
+                                      struct nlmon_event *event, time_t now)
+{
+	struct nlmon_neigh_info *neigh;
+	struct neighbor_tracker *tracker;
+	struct detector_shard *shard;
+	double distinct = 0.0;
+	uint64_t hash;
+	
+	if (sd->config.arp_distinct_threshold == 0 ||
+	    event->netlink.protocol != NETLINK_ROUTE)
+		return 0.0;
+	
+	nlmon_event_materialize(event);
+	neigh = event->netlink.data.neigh;
+	if (!neigh)
+		return 0.0;
+	
+	/* A neighbor is its address with its link-layer address */
+	hash = sketch_hash(neigh->lladdr, sizeof(neigh->lladdr), 0);
+	hash = sketch_hash(neigh->dst, strnlen(neigh->dst, sizeof(neigh->dst)), hash);
+	
+	shard = interface_shard(sd, interface_hash(event->interface));
+	pthread_mutex_lock(&shard->mutex);
+	
+	tracker = neighbor_tracker(sd, shard, event->interface, now);
+	hyperloglog_add(&tracker->addresses, hash);
+	if (!tracker->alerted) {
+		distinct = hyperloglog_estimate(&tracker->addresses);
+		if (distinct > (double)sd->config.arp_distinct_threshold)
+			tracker->alerted = true;
+		else
+			distinct = 0.0;
+	}
+	
+	pthread_mutex_unlock(&shard->mutex);
+	return distinct;
+}
+
 /* Detect ARP flood */
 static bool detect_arp_flood(struct security_detector *sd,
                              struct nlmon_event *event)
 {
 	struct security_event sec_event;
-	time_t now, cutoff;
+	time_t now;
 	size_t count;
-	double rate;
-	
-	if (!sd->config.enable_arp_flood_detection)
-		return false;
-	
-	/* Check if this is a new neighbor (ARP) event */
-	if (event->message_type != RTM_NEWNEIGH)
-		return false;
+	double rate, distinct;
 	
 	pthread_mutex_lock(&sd->arp_mutex);
 	
-	now = get_current_time();
-	cutoff = now - sd->config.arp_time_window;
+	now = nlmon_clock_seconds();
 	
-	/* Clean old entries */
-	clean_time_window(&sd->arp_window, cutoff);
-	
-	/* Add new entry */
-	add_time_window_entry(&sd->arp_window, event->interface);
-	
-	/* Count entries in window */
-	count = count_time_window(sd->arp_window);
+	/* Count the event, expiring the ones older than the window */
+	window_counter_add(sd->arp_window, now, 1);
+	count = window_counter_count(sd->arp_window, now);
 	
 	pthread_mutex_unlock(&sd->arp_mutex);
 	
+	distinct = count_distinct_neighbor(sd, event, now);
+	
 	/* Calculate rate */
 	rate = (double)count / sd->config.arp_time_window;
 	
 	/* Check threshold */
-	if (rate > sd->config.arp_rate_threshold) {
+	if (rate > sd->config.arp_rate_threshold || distinct > 0.0) {
 		memset(&sec_event, 0, sizeof(sec_event));
 		sec_event.type = SECURITY_ARP_FLOOD;
 		sec_event.severity = SECURITY_MEDIUM;
 		sec_event.timestamp = now;
 		strncpy(sec_event.interface, event->interface,
 		        sizeof(sec_event.interface) - 1);
-		snprintf(sec_event.description, sizeof(sec_event.description),
-		         "ARP flood detected on %s: %.1f entries/sec (threshold: %.1f)",
-		         event->interface, rate, sd->config.arp_rate_threshold);
+		if (rate > sd->config.arp_rate_threshold)
+			snprintf(sec_event.description, sizeof(sec_event.description),
+			         "ARP flood detected on %s: %.1f entries/sec (threshold: %.1f)",
+			         event->interface, rate, sd->config.arp_rate_threshold);
+		else
+			snprintf(sec_event.description, sizeof(sec_event.description),
+			         "ARP flood detected on %s: ~%.0f distinct neighbors in %zu seconds (threshold: %zu)",
+			         event->interface, distinct, sd->config.arp_time_window,
+			         sd->config.arp_distinct_threshold);
 		
 		emit_security_event(sd, &sec_event);
 		atomic_fetch_add_explicit(&sd->arp_flood_events, 1,
@@ -262,31 +338,17 @@ static bool detect_neighbor_flood(struct security_detector *sd,
                                   struct nlmon_event *event)
 {
 	struct security_event sec_event;
-	time_t now, cutoff;
+	time_t now;
 	size_t count;
 	double rate;
 	
-	if (!sd->config.enable_neighbor_flood_detection)
-		return false;
-	
-	/* Check if this is a neighbor event */
-	if (event->message_type != RTM_NEWNEIGH &&
-	    event->message_type != RTM_DELNEIGH)
-		return false;
-	
 	pthread_mutex_lock(&sd->neighbor_mutex);
 	
-	now = get_current_time();
-	cutoff = now - sd->config.neighbor_time_window;
+	now = nlmon_clock_seconds();
 	
-	/* Clean old entries */
-	clean_time_window(&sd->neighbor_window, cutoff);
-	
-	/* Add new entry */
-	add_time_window_entry(&sd->neighbor_window, event->interface);
-	
-	/* Count entries in window */
-	count = count_time_window(sd->neighbor_window);
+	/* Count the event, expiring the ones older than the window */
+	window_counter_add(sd->neighbor_window, now, 1);
+	count = window_counter_count(sd->neighbor_window, now);
 	
 	pthread_mutex_unlock(&sd->neighbor_mutex);
 	
@@ -314,61 +376,177 @@ static bool detect_neighbor_flood(struct security_detector *sd,
 	return false;
 }
 
-/* Detect route hijacking */
+/* Neighbor states with a link-layer address the kernel sends to */
+#define NUD_VALID_LLADDR (NUD_REACHABLE | NUD_STALE | NUD_DELAY | NUD_PROBE | \
+                          NUD_PERMANENT | NUD_NOARP)
+
+static bool lladdr_is_zero(const unsigned char *lladdr)
+{
+	static const unsigned char zero[6];
+	
+	return memcmp(lladdr, zero, sizeof(zero)) == 0;
+}
+
+static void format_lladdr(const unsigned char *lladdr, char *buf, size_t len)
+{
+	snprintf(buf, len, "%02x:%02x:%02x:%02x:%02x:%02x",
+	         lladdr[0], lladdr[1], lladdr[2], lladdr[3], lladdr[4], lladdr[5]);
+}
+
+/* Detect neighbor spoofing
+ *
+ * Flags a resolved neighbor whose link-layer address moves to another one,
+ * the mark of a poisoned ARP or neighbor discovery cache. The neighbor
+ * mirror is updated whether or not detection is enabled.
+ */
+static bool detect_neighbor_spoof(struct security_detector *sd,
+                                  struct nlmon_event *event)
+{
+	struct security_event sec_event;
+	struct nlmon_neigh_info *neigh;
+	struct neigh_mirror_entry prev;
+	char before[18], after[18];
+	int ret;
+	
+	if (event->netlink.protocol != NETLINK_ROUTE)
+		return false;
+	
+	nlmon_event_materialize(event);
+	neigh = event->netlink.data.neigh;
+	if (!neigh)
+		return false;
+	
+	ret = neigh_mirror_update(sd->neigh_mirror, event->message_type, neigh,
+	                          nlmon_clock_seconds(), &prev);
+	
+	if (!sd->config.enable_neighbor_spoof_detection || ret != 1 ||
+	    event->message_type != RTM_NEWNEIGH)
+		return false;
+	if (!(neigh->state & NUD_VALID_LLADDR) || lladdr_is_zero(neigh->lladdr) ||
+	    lladdr_is_zero(prev.lladdr) ||
+	    memcmp(prev.lladdr, neigh->lladdr, sizeof(prev.lladdr)) == 0)
+		return false;
+	
+	format_lladdr(prev.lladdr, before, sizeof(before));
+	format_lladdr(neigh->lladdr, after, sizeof(after));
+	
+	memset(&sec_event, 0, sizeof(sec_event));
+	sec_event.type = SECURITY_NEIGHBOR_SPOOF;
+	sec_event.severity = SECURITY_HIGH;
+	sec_event.timestamp = nlmon_clock_seconds();
+	strncpy(sec_event.interface, event->interface,
+	        sizeof(sec_event.interface) - 1);
+	snprintf(sec_event.description, sizeof(sec_event.description),
+	         "Neighbor %.46s on ifindex %d moved from %s to %s",
+	         neigh->dst, neigh->ifindex, before, after);
+	
+	emit_security_event(sd, &sec_event);
+	atomic_fetch_add_explicit(&sd->neighbor_spoof_events, 1,
+	                          memory_order_relaxed);
+	return true;
+}
+
+/* Keep the conntrack mirror on the flows of conntrack events */
+static bool track_conntrack(struct security_detector *sd,
+                            struct nlmon_event *event)
+{
+	nlmon_event_materialize(event);
+	if (event->netlink.data.conntrack)
+		ct_mirror_update(sd->ct_mirror, NFNL_MSG_TYPE(event->netlink.msg_type),
+		                 event->netlink.data.conntrack, nlmon_clock_seconds());
+	return false;
+}
+
+/* Next hop of a route for descriptions */
+static void describe_next_hop(const char *gateway, int oif, char *buf, size_t len)
+{
+	if (gateway[0])
+		snprintf(buf, len, "via %.46s", gateway);
+	else
+		snprintf(buf, len, "oif %d", oif);
+}
+
+/* Whether a route leaves by the same next hop as a mirrored one */
+static bool same_next_hop(const struct nlmon_route_info *route,
+                          const struct fib_mirror_route *mirrored)
+{
+	return route->oif == mirrored->oif &&
+	       strncmp(route->gateway, mirrored->gateway, sizeof(route->gateway)) == 0;
+}
+
+/* Detect route hijacking
+ *
+ * Flags a unicast route that moves an existing one to another next hop,
+ * and a more specific prefix that takes part of the traffic of a covering
+ * unicast route elsewhere. Routes the kernel adds for local addresses, the
+ * local table and the default route covering everything are not judged.
+ */
 static bool detect_route_hijack(struct security_detector *sd,
                                 struct nlmon_event *event)
 {
 	struct security_event sec_event;
-	struct route_entry *route;
+	struct nlmon_route_info *route;
+	struct fib_mirror_route mirrored;
+	char before[64], after[64];
 	bool hijack_detected = false;
+	bool watched;
 	
-	if (!sd->config.enable_route_hijack_detection)
+	if (event->netlink.protocol != NETLINK_ROUTE)
 		return false;
 	
-	/* Check if this is a route change event */
-	if (event->message_type != RTM_NEWROUTE &&
-	    event->message_type != RTM_DELROUTE)
+	nlmon_event_materialize(event);
+	route = event->netlink.data.route;
+	if (!route)
 		return false;
 	
-	/* For route hijack detection, we would need to parse the route data
-	 * and check for suspicious changes (e.g., default route changes,
-	 * gateway changes for existing routes). This is a simplified version. */
+	watched = sd->config.enable_route_hijack_detection &&
+	          route->type == RTN_UNICAST && route->table != RT_TABLE_LOCAL;
+	
+	memset(&sec_event, 0, sizeof(sec_event));
 	
 	pthread_mutex_lock(&sd->route_mutex);
 	
-	/* Check for suspicious route changes */
-	if (event->message_type == RTM_NEWROUTE && event->data) {
-		/* In a real implementation, we would parse the route attributes
-		 * and check for suspicious patterns like:
-		 * - Default route (0.0.0.0/0) changes
-		 * - Gateway changes for existing routes
-		 * - Routes to private networks via unexpected gateways
-		 */
-		
-		/* For now, just track route additions */
-		route = malloc(sizeof(*route));
-		if (route) {
-			memset(route, 0, sizeof(*route));
-			route->timestamp = get_current_time();
-			strncpy(route->interface, event->interface,
-			        sizeof(route->interface) - 1);
-			route->next = sd->routes;
-			sd->routes = route;
+	if (event->message_type == RTM_DELROUTE) {
+		fib_mirror_delete(sd->fib, route);
+		pthread_mutex_unlock(&sd->route_mutex);
+		return false;
+	}
+	
+	describe_next_hop(route->gateway, route->oif, after, sizeof(after));
+	
+	if (watched && fib_mirror_find(sd->fib, route, &mirrored)) {
+		/* Gateway or interface change of an existing route */
+		if (mirrored.type == RTN_UNICAST && !same_next_hop(route, &mirrored)) {
+			describe_next_hop(mirrored.gateway, mirrored.oif, before, sizeof(before));
+			snprintf(sec_event.description, sizeof(sec_event.description),
+			         "Route %.46s/%u in table %u moved from %.63s to %.63s",
+			         mirrored.dst, mirrored.dst_len, route->table, before, after);
+			hijack_detected = true;
+		}
+	} else if (watched && route->protocol != RTPROT_KERNEL &&
+	           fib_mirror_covering(sd->fib, route, &mirrored)) {
+		/* More specific prefix diverting part of a covering route */
+		if (mirrored.dst_len > 0 && mirrored.type == RTN_UNICAST &&
+		    !same_next_hop(route, &mirrored)) {
+			describe_next_hop(mirrored.gateway, mirrored.oif, before, sizeof(before));
+			snprintf(sec_event.description, sizeof(sec_event.description),
+			         "Route %.46s/%u %.63s diverts traffic of %.46s/%u %.63s",
+			         route->dst, route->dst_len, after,
+			         mirrored.dst, mirrored.dst_len, before);
+			hijack_detected = true;
 		}
 	}
 	
+	fib_mirror_add(sd->fib, route, nlmon_clock_seconds());
+	
 	pthread_mutex_unlock(&sd->route_mutex);
 	
 	if (hijack_detected) {
-		memset(&sec_event, 0, sizeof(sec_event));
 		sec_event.type = SECURITY_ROUTE_HIJACK;
 		sec_event.severity = SECURITY_CRITICAL;
-		sec_event.timestamp = get_current_time();
+		sec_event.timestamp = nlmon_clock_seconds();
 		strncpy(sec_event.interface, event->interface,
 		        sizeof(sec_event.interface) - 1);
-		snprintf(sec_event.description, sizeof(sec_event.description),
-		         "Suspicious route change detected on %s",
-		         event->interface);
 		
 		emit_security_event(sd, &sec_event);
 		atomic_fetch_add_explicit(&sd->route_hijack_events, 1,
@@ -384,59 +562,33 @@ static bool detect_interface_storm(struct security_detector *sd,
                                    struct nlmon_event *event)
 {
 	struct security_event sec_event;
-	struct interface_tracker *tracker;
-	time_t now;
-	bool storm_detected = false;
+	struct detector_shard *shard;
+	uint32_t threshold, count;
+	time_t now, epoch;
+	bool storm_detected;
+	uint64_t hash;
 	
-	if (!sd->config.enable_interface_storm_detection)
-		return false;
+	hash = interface_hash(event->interface);
+	shard = interface_shard(sd, hash);
 	
-	/* Check if this is a link event */
-	if (event->message_type != RTM_NEWLINK &&
-	    event->message_type != RTM_DELLINK)
-		return false;
+	pthread_mutex_lock(&shard->mutex);
 	
-	pthread_mutex_lock(&sd->interface_mutex);
+	now = nlmon_clock_seconds();
 	
-	now = get_current_time();
-	
-	/* Find or create tracker for this interface */
-	for (tracker = sd->interface_trackers; tracker; tracker = tracker->next) {
-		if (strcmp(tracker->interface, event->interface) == 0)
-			break;
+	/* Count per interface in the current window, every interface starts it at zero */
+	epoch = now / (time_t)sd->config.interface_storm_window;
+	if (epoch != shard->storm_epoch) {
+		count_min_reset(shard->storm_sketch);
+		shard->storm_epoch = epoch;
 	}
 	
-	if (!tracker) {
-		tracker = malloc(sizeof(*tracker));
-		if (tracker) {
-			memset(tracker, 0, sizeof(*tracker));
-			strncpy(tracker->interface, event->interface,
-			        sizeof(tracker->interface) - 1);
-			tracker->window_start = now;
-			tracker->event_count = 0;
-			tracker->next = sd->interface_trackers;
-			sd->interface_trackers = tracker;
-		}
-	}
+	count = count_min_add(shard->storm_sketch, hash, 1);
 	
-	if (tracker) {
-		/* Reset window if expired */
-		if (now - tracker->window_start >= (time_t)sd->config.interface_storm_window) {
-			tracker->window_start = now;
-			tracker->event_count = 0;
-		}
-		
-		tracker->event_count++;
-		
-		/* Check threshold */
-		if (tracker->event_count >= sd->config.interface_storm_threshold) {
-			storm_detected = true;
-			tracker->event_count = 0;  /* Reset to avoid repeated alerts */
-			tracker->window_start = now;
-		}
-	}
+	/* Alert each time another threshold's worth of events is reached */
+	threshold = (uint32_t)sd->config.interface_storm_threshold;
+	storm_detected = count % threshold == 0;
 	
-	pthread_mutex_unlock(&sd->interface_mutex);
+	pthread_mutex_unlock(&shard->mutex);
 	
 	if (storm_detected) {
 		memset(&sec_event, 0, sizeof(sec_event));
@@ -466,13 +618,6 @@ static bool detect_suspicious_interface(struct security_detector *sd,
 	struct security_event sec_event;
 	bool suspicious = false;
 	
-	if (!sd->config.enable_suspicious_interface_detection)
-		return false;
-	
-	/* Check if this is a new link event */
-	if (event->message_type != RTM_NEWLINK)
-		return false;
-	
 	/* Check for suspicious interface name patterns
 	 * This is a simplified check - in production, you'd want more
 	 * sophisticated pattern matching */
@@ -486,7 +631,7 @@ static bool detect_suspicious_interface(struct security_detector *sd,
 		memset(&sec_event, 0, sizeof(sec_event));
 		sec_event.type = SECURITY_SUSPICIOUS_INTERFACE;
 		sec_event.severity = SECURITY_LOW;
-		sec_event.timestamp = get_current_time();
+		sec_event.timestamp = nlmon_clock_seconds();
 		strncpy(sec_event.interface, event->interface,
 		        sizeof(sec_event.interface) - 1);
 		snprintf(sec_event.description, sizeof(sec_event.description),
@@ -500,6 +645,114 @@ static bool detect_suspicious_interface(struct security_detector *sd,
 	return false;
 }
 
+/* Detector and the message types it registers */
+struct detector {
+	bool (*detect)(struct security_detector *sd, struct nlmon_event *event);
+	size_t enable;                  /* Offset of its config switch */
+	bool conntrack;                 /* Types are ctnetlink messages */
+	size_t num_types;
+	uint16_t types[DETECTOR_MAX_TYPES];
+};
+
+/* Detectors keeping a mirror run whether or not they are enabled */
+#define DETECTOR_ALWAYS SIZE_MAX
+#define DETECTOR_ENABLE(field) offsetof(struct security_detector_config, field)
+
+/* Detectors in the order they run for an event */
+static const struct detector detectors[] = {
+	{ detect_promiscuous_mode, DETECTOR_ENABLE(enable_promisc_detection),
+	  false, 1, { RTM_NEWLINK } },
+	{ detect_arp_flood, DETECTOR_ENABLE(enable_arp_flood_detection),
+	  false, 1, { RTM_NEWNEIGH } },
+	{ detect_neighbor_flood, DETECTOR_ENABLE(enable_neighbor_flood_detection),
+	  false, 2, { RTM_NEWNEIGH, RTM_DELNEIGH } },
+	{ detect_route_hijack, DETECTOR_ALWAYS,
+	  false, 2, { RTM_NEWROUTE, RTM_DELROUTE } },
+	{ detect_interface_storm, DETECTOR_ENABLE(enable_interface_storm_detection),
+	  false, 2, { RTM_NEWLINK, RTM_DELLINK } },
+	{ detect_suspicious_interface, DETECTOR_ENABLE(enable_suspicious_interface_detection),
+	  false, 1, { RTM_NEWLINK } },
+	{ detect_neighbor_spoof, DETECTOR_ALWAYS,
+	  false, 2, { RTM_NEWNEIGH, RTM_DELNEIGH } },
+	{ track_conntrack, DETECTOR_ALWAYS,
+	  true, 2, { IPCTNL_MSG_CT_NEW, IPCTNL_MSG_CT_DELETE } },
+};
+
+_Static_assert(sizeof(detectors) / sizeof(detectors[0]) <= DETECTORS_MAX,
+               "dispatch slots index detectors by uint8_t up to DETECTORS_MAX");
+_Static_assert(RTM_MAX < DISPATCH_ROUTE_TYPES, "rtnetlink types must fit the dispatch table");
+
+/* Dispatch slot of a message type */
+static size_t dispatch_index(bool conntrack, uint16_t type)
+{
+	return conntrack ? DISPATCH_ROUTE_TYPES + type : type;
+}
+
+/* Register the enabled detectors under their message types */
+static void build_dispatch(struct security_detector *sd)
+{
+	const struct detector *detector;
+	struct dispatch_slot *slot;
+	
+	for (size_t i = 0; i < sizeof(detectors) / sizeof(detectors[0]); i++) {
+		detector = &detectors[i];
+		if (detector->enable != DETECTOR_ALWAYS &&
+		    !*(const bool *)((const char *)&sd->config + detector->enable))
+			continue;
+		
+		for (size_t t = 0; t < detector->num_types; t++) {
+			slot = &sd->dispatch[dispatch_index(detector->conntrack, detector->types[t])];
+			slot->detectors[slot->count++] = (uint8_t)i;
+		}
+	}
+}
+
+/* Dispatch slot of an event, NULL if no detector handles its type */
+static const struct dispatch_slot *event_dispatch(struct security_detector *sd,
+                                                  const struct nlmon_event *event)
+{
+	uint16_t type;
+	
+	if (event->netlink.protocol == NETLINK_NETFILTER &&
+	    NFNL_SUBSYS_ID(event->netlink.msg_type) == NFNL_SUBSYS_CTNETLINK) {
+		type = NFNL_MSG_TYPE(event->netlink.msg_type);
+		if (type >= IPCTNL_MSG_MAX)
+			return NULL;
+		return &sd->dispatch[dispatch_index(true, type)];
+	}
+	
+	if (event->message_type >= DISPATCH_ROUTE_TYPES)
+		return NULL;
+	return &sd->dispatch[dispatch_index(false, event->message_type)];
+}
+
+static void destroy_shards(struct security_detector *sd, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		count_min_destroy(sd->shards[i].storm_sketch);
+		pthread_mutex_destroy(&sd->shards[i].mutex);
+	}
+}
+
+static bool create_shards(struct security_detector *sd)
+{
+	struct detector_shard *shard;
+	
+	for (size_t i = 0; i < DETECTOR_SHARDS; i++) {
+		shard = &sd->shards[i];
+		
+		/* Each shard counts the storms of its share of the interfaces */
+		shard->storm_sketch = count_min_create(STORM_SKETCH_WIDTH / DETECTOR_SHARDS);
+		if (!shard->storm_sketch || pthread_mutex_init(&shard->mutex, NULL) != 0) {
+			count_min_destroy(shard->storm_sketch);
+			destroy_shards(sd, i);
+			return false;
+		}
+	}
+	
+	return true;
+}
+
 struct security_detector *security_detector_create(struct security_detector_config *config)
 {
 	struct security_detector *sd;
@@ -527,17 +780,37 @@ struct security_detector *security_detector_create(struct security_detector_conf
 	if (sd->config.interface_storm_window == 0)
 		sd->config.interface_storm_window = 5;
 	
+	sd->arp_window = window_counter_create((time_t)sd->config.arp_time_window);
+	sd->neighbor_window = window_counter_create((time_t)sd->config.neighbor_time_window);
+	sd->fib = fib_mirror_create(sd->config.route_mirror_limit);
+	sd->neigh_mirror = neigh_mirror_create(sd->config.neighbor_mirror_limit);
+	sd->ct_mirror = ct_mirror_create(sd->config.conntrack_mirror_limit);
+	if (!sd->arp_window || !sd->neighbor_window || !sd->fib ||
+	    !sd->neigh_mirror || !sd->ct_mirror || !create_shards(sd)) {
+		window_counter_destroy(sd->arp_window);
+		window_counter_destroy(sd->neighbor_window);
+		fib_mirror_destroy(sd->fib);
+		neigh_mirror_destroy(sd->neigh_mirror);
+		ct_mirror_destroy(sd->ct_mirror);
+		free(sd);
+		return NULL;
+	}
+	
 	/* Initialize mutexes */
 	if (pthread_mutex_init(&sd->arp_mutex, NULL) != 0 ||
 	    pthread_mutex_init(&sd->neighbor_mutex, NULL) != 0 ||
-	    pthread_mutex_init(&sd->interface_mutex, NULL) != 0 ||
 	    pthread_mutex_init(&sd->route_mutex, NULL) != 0 ||
 	    pthread_mutex_init(&sd->callback_mutex, NULL) != 0) {
 		pthread_mutex_destroy(&sd->arp_mutex);
 		pthread_mutex_destroy(&sd->neighbor_mutex);
-		pthread_mutex_destroy(&sd->interface_mutex);
 		pthread_mutex_destroy(&sd->route_mutex);
 		pthread_mutex_destroy(&sd->callback_mutex);
+		destroy_shards(sd, DETECTOR_SHARDS);
+		window_counter_destroy(sd->arp_window);
+		window_counter_destroy(sd->neighbor_window);
+		fib_mirror_destroy(sd->fib);
+		neigh_mirror_destroy(sd->neigh_mirror);
+		ct_mirror_destroy(sd->ct_mirror);
 		free(sd);
 		return NULL;
 	}
@@ -550,53 +823,28 @@ struct security_detector *security_detector_create(struct security_detector_conf
 	atomic_init(&sd->route_hijack_events, 0);
 	atomic_init(&sd->neighbor_flood_events, 0);
 	atomic_init(&sd->interface_storm_events, 0);
+	atomic_init(&sd->neighbor_spoof_events, 0);
 	
 	sd->next_callback_id = 1;
 	
+	build_dispatch(sd);
+	
 	return sd;
 }
 
 void security_detector_destroy(struct security_detector *sd)
 {
-	struct time_window_entry *tw_entry, *tw_next;
-	struct interface_tracker *if_tracker, *if_next;
-	struct route_entry *route, *route_next;
 	struct callback_entry *cb, *cb_next;
 	
 	if (!sd)
 		return;
 	
-	/* Free ARP window */
-	tw_entry = sd->arp_window;
-	while (tw_entry) {
-		tw_next = tw_entry->next;
-		free(tw_entry);
-		tw_entry = tw_next;
-	}
-	
-	/* Free neighbor window */
-	tw_entry = sd->neighbor_window;
-	while (tw_entry) {
-		tw_next = tw_entry->next;
-		free(tw_entry);
-		tw_entry = tw_next;
-	}
-	
-	/* Free interface trackers */
-	if_tracker = sd->interface_trackers;
-	while (if_tracker) {
-		if_next = if_tracker->next;
-		free(if_tracker);
-		if_tracker = if_next;
-	}
-	
-	/* Free routes */
-	route = sd->routes;
-	while (route) {
-		route_next = route->next;
-		free(route);
-		route = route_next;
-	}
+	window_counter_destroy(sd->arp_window);
+	window_counter_destroy(sd->neighbor_window);
+	destroy_shards(sd, DETECTOR_SHARDS);
+	fib_mirror_destroy(sd->fib);
+	neigh_mirror_destroy(sd->neigh_mirror);
+	ct_mirror_destroy(sd->ct_mirror);
 	
 	/* Free callbacks */
 	cb = sd->callbacks;
@@ -609,7 +857,6 @@ void security_detector_destroy(struct security_detector *sd)
 	/* Destroy mutexes */
 	pthread_mutex_destroy(&sd->arp_mutex);
 	pthread_mutex_destroy(&sd->neighbor_mutex);
-	pthread_mutex_destroy(&sd->interface_mutex);
 	pthread_mutex_destroy(&sd->route_mutex);
 	pthread_mutex_destroy(&sd->callback_mutex);
 	
@@ -672,6 +919,7 @@ void security_detector_unregister_callback(struct security_detector *sd, int cal
 bool security_detector_process_event(struct security_detector *sd,
                                      struct nlmon_event *event)
 {
+	const struct dispatch_slot *slot;
 	bool detected = false;
 	
 	if (!sd || !event)
@@ -679,28 +927,34 @@ bool security_detector_process_event(struct security_detector *sd,
 	
 	atomic_fetch_add_explicit(&sd->events_processed, 1, memory_order_relaxed);
 	
-	/* Run all enabled detectors */
-	if (detect_promiscuous_mode(sd, event))
-		detected = true;
-	
-	if (detect_arp_flood(sd, event))
-		detected = true;
-	
-	if (detect_neighbor_flood(sd, event))
-		detected = true;
-	
-	if (detect_route_hijack(sd, event))
-		detected = true;
-	
-	if (detect_interface_storm(sd, event))
-		detected = true;
+	/* Run the enabled detectors registered for the message type */
+	slot = event_dispatch(sd, event);
+	if (!slot)
+		return false;
 	
-	if (detect_suspicious_interface(sd, event))
-		detected = true;
+	for (size_t i = 0; i < slot->count; i++) {
+		if (detectors[slot->detectors[i]].detect(sd, event))
+			detected = true;
+	}
 	
 	return detected;
 }
 
+struct fib_mirror *security_detector_routes(struct security_detector *sd)
+{
+	return sd ? sd->fib : NULL;
+}
+
+struct neigh_mirror *security_detector_neighbors(struct security_detector *sd)
+{
+	return sd ? sd->neigh_mirror : NULL;
+}
+
+struct ct_mirror *security_detector_flows(struct security_detector *sd)
+{
+	return sd ? sd->ct_mirror : NULL;
+}
+
 void security_detector_stats(struct security_detector *sd,
                             unsigned long *events_processed,
                             unsigned long *security_events,
@@ -730,44 +984,28 @@ void security_detector_stats(struct security_detector *sd,
 
 void security_detector_reset(struct security_detector *sd)
 {
-	struct time_window_entry *tw_entry, *tw_next;
-	struct interface_tracker *if_tracker, *if_next;
-	
 	if (!sd)
 		return;
 	
 	/* Clear ARP window */
 	pthread_mutex_lock(&sd->arp_mutex);
-	tw_entry = sd->arp_window;
-	while (tw_entry) {
-		tw_next = tw_entry->next;
-		free(tw_entry);
-		tw_entry = tw_next;
-	}
-	sd->arp_window = NULL;
+	window_counter_reset(sd->arp_window);
 	pthread_mutex_unlock(&sd->arp_mutex);
 	
 	/* Clear neighbor window */
 	pthread_mutex_lock(&sd->neighbor_mutex);
-	tw_entry = sd->neighbor_window;
-	while (tw_entry) {
-		tw_next = tw_entry->next;
-		free(tw_entry);
-		tw_entry = tw_next;
-	}
-	sd->neighbor_window = NULL;
+	window_counter_reset(sd->neighbor_window);
 	pthread_mutex_unlock(&sd->neighbor_mutex);
 	
-	/* Clear interface trackers */
-	pthread_mutex_lock(&sd->interface_mutex);
-	if_tracker = sd->interface_trackers;
-	while (if_tracker) {
-		if_next = if_tracker->next;
-		free(if_tracker);
-		if_tracker = if_next;
+	/* Clear neighbor trackers and interface storm counts */
+	for (size_t i = 0; i < DETECTOR_SHARDS; i++) {
+		pthread_mutex_lock(&sd->shards[i].mutex);
+		memset(sd->shards[i].neighbors, 0, sizeof(sd->shards[i].neighbors));
+		count_min_reset(sd->shards[i].storm_sketch);
+		pthread_mutex_unlock(&sd->shards[i].mutex);
 	}
-	sd->interface_trackers = NULL;
-	pthread_mutex_unlock(&sd->interface_mutex);
+	
+	/* The mirrors follow the kernel's tables and are kept */
 	
 	/* Reset statistics */
 	atomic_store_explicit(&sd->events_processed, 0, memory_order_relaxed);
@@ -777,6 +1015,7 @@ void security_detector_reset(struct security_detector *sd)
 	atomic_store_explicit(&sd->route_hijack_events, 0, memory_order_relaxed);
 	atomic_store_explicit(&sd->neighbor_flood_events, 0, memory_order_relaxed);
 	atomic_store_explicit(&sd->interface_storm_events, 0, memory_order_relaxed);
+	atomic_store_explicit(&sd->neighbor_spoof_events, 0, memory_order_relaxed);
 }
 
 const char *security_event_severity_string(enum security_severity severity)
@@ -812,6 +1051,8 @@ const char *security_event_type_string(enum security_event_type type)
 		return "NEIGHBOR_FLOOD";
 	case SECURITY_INTERFACE_STORM:
 		return "INTERFACE_STORM";
+	case SECURITY_NEIGHBOR_SPOOF:
+		return "NEIGHBOR_SPOOF";
 	default:
 		return "UNKNOWN";
 	}
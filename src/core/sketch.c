@@ -0,0 +1,178 @@
+/* sketch.c - Fixed memory summaries of event streams
+ *
+ * Count-min rows are indexed by double hashing, row i uses h1 + i * h2
+ * of the one 64-bit key hash. Adding only raises the counters that are
+ * below the key's new estimate (conservative update), which keeps
+ * overcounts of other keys as small as the sketch allows.
+ *
+ * The HyperLogLog uses the top bits of the hash as register index and
+ * the rank of the first set bit of the rest as register value, with
+ * linear counting for small cardinalities.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sketch.h"
+
+struct count_min {
+	uint32_t *counters;             /* COUNT_MIN_DEPTH rows of width */
+	size_t width;
+	size_t mask;
+};
+
+/* FNV-1a with a final avalanche so that all bits depend on the key */
+uint64_t sketch_hash(const void *key, size_t len, uint64_t seed)
+{
+	const unsigned char *p = key;
+	uint64_t hash = 14695981039346656037ULL ^ seed;
+	
+	for (size_t i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+struct count_min *count_min_create(size_t width)
+{
+	struct count_min *cm;
+	size_t w = 1;
+	
+	if (width == 0)
+		return NULL;
+	
+	while (w < width)
+		w <<= 1;
+	
+	cm = calloc(1, sizeof(*cm));
+	if (!cm)
+		return NULL;
+	
+	cm->counters = calloc(COUNT_MIN_DEPTH * w, sizeof(*cm->counters));
+	if (!cm->counters) {
+		free(cm);
+		return NULL;
+	}
+	
+	cm->width = w;
+	cm->mask = w - 1;
+	return cm;
+}
+
+void count_min_destroy(struct count_min *cm)
+{
+	if (!cm)
+		return;
+	
+	free(cm->counters);
+	free(cm);
+}
+
+/* Counter of row for hash */
+static size_t count_min_index(const struct count_min *cm, uint64_t hash, size_t row)
+{
+	uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32) | 1;
+	
+	return row * cm->width + ((h1 + row * h2) & cm->mask);
+}
+
+uint32_t count_min_add(struct count_min *cm, uint64_t hash, uint32_t n)
+{
+	size_t index[COUNT_MIN_DEPTH];
+	uint32_t estimate = UINT32_MAX;
+	
+	if (!cm)
+		return 0;
+	
+	for (size_t row = 0; row < COUNT_MIN_DEPTH; row++) {
+		index[row] = count_min_index(cm, hash, row);
+		if (cm->counters[index[row]] < estimate)
+			estimate = cm->counters[index[row]];
+	}
+	
+	estimate = estimate > UINT32_MAX - n ? UINT32_MAX : estimate + n;
+	for (size_t row = 0; row < COUNT_MIN_DEPTH; row++) {
+		if (cm->counters[index[row]] < estimate)
+			cm->counters[index[row]] = estimate;
+	}
+	
+	return estimate;
+}
+
+uint32_t count_min_estimate(const struct count_min *cm, uint64_t hash)
+{
+	uint32_t estimate = UINT32_MAX;
+	
+	if (!cm)
+		return 0;
+	
+	for (size_t row = 0; row < COUNT_MIN_DEPTH; row++) {
+		uint32_t count = cm->counters[count_min_index(cm, hash, row)];
+		
+		if (count < estimate)
+			estimate = count;
+	}
+	
+	return estimate;
+}
+
+void count_min_reset(struct count_min *cm)
+{
+	if (!cm)
+		return;
+	
+	memset(cm->counters, 0, COUNT_MIN_DEPTH * cm->width * sizeof(*cm->counters));
+}
+
+void hyperloglog_add(struct hyperloglog *hll, uint64_t hash)
+{
+	size_t index = (size_t)(hash >> (64 - HYPERLOGLOG_PRECISION));
+	uint64_t rest = hash << HYPERLOGLOG_PRECISION;
+	uint8_t rank;
+	
+	if (!hll)
+		return;
+	
+	rank = rest ? (uint8_t)(__builtin_clzll(rest) + 1) : 64 - HYPERLOGLOG_PRECISION + 1;
+	if (rank > hll->registers[index])
+		hll->registers[index] = rank;
+}
+
+double hyperloglog_estimate(const struct hyperloglog *hll)
+{
+	const double m = HYPERLOGLOG_REGISTERS;
+	double sum = 0.0, estimate;
+	size_t zeros = 0;
+	
+	if (!hll)
+		return 0.0;
+	
+	for (size_t i = 0; i < HYPERLOGLOG_REGISTERS; i++) {
+		sum += ldexp(1.0, -hll->registers[i]);
+		if (hll->registers[i] == 0)
+			zeros++;
+	}
+	
+	estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+	
+	/* Linear counting is more accurate while registers are still empty */
+	if (estimate <= 2.5 * m && zeros)
+		estimate = m * log(m / (double)zeros);
+	
+	return estimate;
+}
+
+void hyperloglog_reset(struct hyperloglog *hll)
+{
+	if (!hll)
+		return;
+	
+	memset(hll->registers, 0, sizeof(hll->registers));
+}
@@ -0,0 +1,515 @@
+/* stack_sampler.c - Sampling profiler of the process's stacks
+ *
+ * The SIGPROF handler only takes a slot of the capture's preallocated
+ * sample array and fills it with backtrace(), which is safe there once it
+ * has been called outside a handler to load the unwinder. Everything else,
+ * reading thread names, dladdr() and folding equal stacks, happens after
+ * the timer is disarmed and the last handler has returned.
+ *
+ * Folding goes by function name rather than address, so two samples at
+ * different points of the same functions make one line.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <ucontext.h>
+#include "stack_sampler.h"
+#include "json_buf.h"
+
+/* Frames of the handler and the signal trampoline above the sampled one,
+ * when the interrupted instruction cannot be found among the frames */
+#define SKIP_FRAMES 2
+
+struct stack_sample {
+	_Atomic bool ready;             /* Written by its handler */
+	uint32_t depth;
+	pid_t tid;
+	void *frames[STACK_SAMPLER_MAX_DEPTH];  /* Innermost first */
+};
+
+struct stack_profile {
+	struct stack_sample *samples;
+	size_t max_samples;
+	_Atomic size_t next;            /* Slots taken, dropped ones included */
+	_Atomic uint64_t dropped;
+	size_t count;                   /* Samples written, once stopped */
+	
+	/* Function name ids of the stacks, outermost first, once stopped */
+	uint32_t *stacks;
+	char **names;
+	size_t num_names;
+	const char **thread_names;      /* Per sample */
+};
+
+/* Distinct address of the stacks and its symbol */
+struct frame_symbol {
+	void *addr;
+	const char *name;
+	uint32_t id;
+};
+
+/* A sample ordered for folding */
+struct fold_entry {
+	const char *thread;
+	const uint32_t *stack;
+	uint32_t depth;
+};
+
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic(struct stack_profile *) active_profile;
+static _Atomic int handlers_running;
+
+/* Instruction a signal interrupted, NULL where unknown */
+static void *interrupted_pc(void *ucontext)
+{
+	ucontext_t *uc = ucontext;
+	
+#if defined(__x86_64__)
+	return (void *)uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+	return (void *)uc->uc_mcontext.pc;
+#else
+	(void)uc;
+	return NULL;
+#endif
+}
+
+static void sample_handler(int sig, siginfo_t *info, void *ucontext)
+{
+	void *frames[STACK_SAMPLER_MAX_DEPTH + SKIP_FRAMES];
+	int saved_errno = errno;
+	struct stack_profile *profile;
+	
+	/* Counted before the profile is read, so the capture can wait for us */
+	atomic_fetch_add(&handlers_running, 1);
+	profile = atomic_load(&active_profile);
+	if (profile) {
+		size_t i = atomic_fetch_add_explicit(&profile->next, 1, memory_order_relaxed);
+		
+		if (i < profile->max_samples) {
+			struct stack_sample *sample = &profile->samples[i];
+			int n = backtrace(frames, STACK_SAMPLER_MAX_DEPTH + SKIP_FRAMES);
+			void *pc = interrupted_pc(ucontext);
+			int skip = SKIP_FRAMES;
+			
+			/* Start from the interrupted frame, whatever wraps the handler */
+			for (int k = 0; pc && k < n; k++) {
+				if (frames[k] == pc) {
+					skip = k;
+					break;
+				}
+			}
+			
+			sample->depth = n > skip ? n - skip : 0;
+			if (sample->depth > STACK_SAMPLER_MAX_DEPTH)
+				sample->depth = STACK_SAMPLER_MAX_DEPTH;
+			memcpy(sample->frames, frames + skip,
+			       sample->depth * sizeof(sample->frames[0]));
+			sample->tid = syscall(SYS_gettid);
+			atomic_store_explicit(&sample->ready, true, memory_order_release);
+		} else {
+			atomic_fetch_add_explicit(&profile->dropped, 1, memory_order_relaxed);
+		}
+	}
+	atomic_fetch_sub(&handlers_running, 1);
+	
+	errno = saved_errno;
+}
+
+static int compare_symbol_addr(const void *a, const void *b)
+{
+	const struct frame_symbol *x = a, *y = b;
+	
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+static int compare_symbol_name(const void *a, const void *b)
+{
+	const struct frame_symbol *const *x = a, *const *y = b;
+	
+	return strcmp((*x)->name, (*y)->name);
+}
+
+static int compare_fold(const void *a, const void *b)
+{
+	const struct fold_entry *x = a, *y = b;
+	int cmp = strcmp(x->thread, y->thread);
+	
+	for (uint32_t i = 0; !cmp && i < x->depth && i < y->depth; i++)
+		cmp = x->stack[i] < y->stack[i] ? -1 : x->stack[i] > y->stack[i];
+	if (!cmp)
+		cmp = x->depth < y->depth ? -1 : x->depth > y->depth;
+	return cmp;
+}
+
+/* Name of a code address, frames are folded on ';' and end at ' ' */
+static char *symbol_name(void *addr)
+{
+	Dl_info info = { 0 };
+	char buf[256];
+	
+	if (!dladdr(addr, &info))
+		memset(&info, 0, sizeof(info));
+	
+	if (info.dli_sname) {
+		snprintf(buf, sizeof(buf), "%s", info.dli_sname);
+	} else if (info.dli_fname && info.dli_fname[0]) {
+		const char *object = strrchr(info.dli_fname, '/');
+		
+		snprintf(buf, sizeof(buf), "%s+0x%lx", object ? object + 1 : info.dli_fname,
+		         (unsigned long)((char *)addr - (char *)info.dli_fbase));
+	} else {
+		snprintf(buf, sizeof(buf), "0x%lx", (unsigned long)addr);
+	}
+	
+	for (char *p = buf; *p; p++) {
+		if (*p == ';' || *p == ' ' || *p == '\n')
+			*p = '_';
+	}
+	return strdup(buf);
+}
+
+/* Name of a thread, kept until the profile is freed */
+static const char *thread_name(struct stack_profile *profile, pid_t tid,
+                               pid_t *tids, const char **names, size_t *count)
+{
+	char path[64], buf[32];
+	FILE *f;
+	size_t i;
+	
+	for (i = 0; i < *count; i++) {
+		if (tids[i] == tid)
+			return names[i];
+	}
+	
+	snprintf(buf, sizeof(buf), "tid-%d", (int)tid);
+	snprintf(path, sizeof(path), "/proc/self/task/%d/comm", (int)tid);
+	f = fopen(path, "r");
+	if (f) {
+		if (fgets(buf, sizeof(buf), f))
+			buf[strcspn(buf, "\n")] = '\0';
+		fclose(f);
+	}
+	for (char *p = buf; *p; p++) {
+		if (*p == ';' || *p == ' ')
+			*p = '_';
+	}
+	
+	/* Names are stored after the function names, freed with them */
+	names[*count] = profile->names[profile->num_names++] = strdup(buf);
+	if (!names[*count])
+		return NULL;
+	tids[*count] = tid;
+	return names[(*count)++];
+}
+
+/* Resolve the written samples to function and thread names */
+static int symbolize(struct stack_profile *profile)
+{
+	struct frame_symbol *symbols = NULL, **by_name = NULL;
+	size_t total = 0, num_symbols = 0, num_threads = 0, i, j;
+	pid_t *tids = NULL;
+	const char **tnames = NULL;
+	int ret = -1;
+	
+	/* Keep the samples written, in order */
+	for (i = 0; i < profile->max_samples && i < atomic_load(&profile->next); i++) {
+		struct stack_sample *sample = &profile->samples[i];
+		
+		if (!atomic_load_explicit(&sample->ready, memory_order_acquire) || !sample->depth)
+			continue;
+		if (i != profile->count)
+			memcpy(&profile->samples[profile->count], sample, sizeof(*sample));
+		
+		/* Callers by the call, not the instruction after it */
+		for (j = 1; j < sample->depth; j++)
+			profile->samples[profile->count].frames[j] = (char *)sample->frames[j] - 1;
+		total += sample->depth;
+		profile->count++;
+	}
+	
+	profile->stacks = calloc(total ? total : 1, sizeof(*profile->stacks));
+	profile->thread_names = calloc(profile->count ? profile->count : 1,
+	                               sizeof(*profile->thread_names));
+	symbols = malloc((total ? total : 1) * sizeof(*symbols));
+	tids = malloc((profile->count ? profile->count : 1) * sizeof(*tids));
+	tnames = malloc((profile->count ? profile->count : 1) * sizeof(*tnames));
+	if (!profile->stacks || !profile->thread_names || !symbols || !tids || !tnames)
+		goto out;
+	
+	/* Distinct addresses */
+	for (i = 0; i < profile->count; i++) {
+		for (j = 0; j < profile->samples[i].depth; j++)
+			symbols[num_symbols++].addr = profile->samples[i].frames[j];
+	}
+	qsort(symbols, num_symbols, sizeof(*symbols), compare_symbol_addr);
+	for (i = 0, j = 0; i < num_symbols; i++) {
+		if (!j || symbols[i].addr != symbols[j - 1].addr)
+			symbols[j++] = symbols[i];
+	}
+	num_symbols = j;
+	
+	/* One id per function name, room for the thread names after them */
+	profile->names = calloc(num_symbols + profile->count + 1, sizeof(*profile->names));
+	by_name = malloc((num_symbols ? num_symbols : 1) * sizeof(*by_name));
+	if (!profile->names || !by_name)
+		goto out;
+	
+	for (i = 0; i < num_symbols; i++) {
+		profile->names[i] = symbol_name(symbols[i].addr);
+		if (!profile->names[i])
+			goto out;
+		symbols[i].name = profile->names[i];
+		by_name[i] = &symbols[i];
+	}
+	profile->num_names = num_symbols;
+	qsort(by_name, num_symbols, sizeof(*by_name), compare_symbol_name);
+	for (i = 0; i < num_symbols; i++) {
+		if (i && !strcmp(by_name[i]->name, by_name[i - 1]->name))
+			by_name[i]->id = by_name[i - 1]->id;
+		else
+			by_name[i]->id = by_name[i] - symbols;
+	}
+	
+	/* Stacks outermost first, as they are folded */
+	for (i = 0, total = 0; i < profile->count; i++) {
+		struct stack_sample *sample = &profile->samples[i];
+		
+		for (j = 0; j < sample->depth; j++) {
+			struct frame_symbol key = { .addr = sample->frames[sample->depth - 1 - j] };
+			struct frame_symbol *symbol = bsearch(&key, symbols, num_symbols,
+			                                      sizeof(*symbols), compare_symbol_addr);
+			
+			profile->stacks[total + j] = symbol->id;
+		}
+		total += sample->depth;
+		
+		profile->thread_names[i] = thread_name(profile, sample->tid, tids, tnames,
+		                                       &num_threads);
+		if (!profile->thread_names[i])
+			goto out;
+	}
+	
+	ret = 0;
+	
+out:
+	free(symbols);
+	free(by_name);
+	free(tids);
+	free(tnames);
+	return ret;
+}
+
+/* Sleep until @end, through the signals of the capture */
+static void sleep_until(const struct timespec *end)
+{
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, end, NULL) == EINTR)
+		;
+}
+
+struct stack_profile *stack_sampler_capture(unsigned int seconds, unsigned int hz)
+{
+	struct sigaction action, old_action;
+	struct itimerval timer = { 0 }, old_timer;
+	struct stack_profile *profile;
+	struct timespec end;
+	void *prime[4];
+	size_t max_samples;
+	long cpus;
+	
+	if (!hz)
+		hz = STACK_SAMPLER_DEFAULT_HZ;
+	if (!seconds || seconds > STACK_SAMPLER_MAX_SECONDS || hz > STACK_SAMPLER_MAX_HZ) {
+		errno = EINVAL;
+		return NULL;
+	}
+	
+	if (pthread_mutex_trylock(&capture_lock) != 0) {
+		errno = EBUSY;
+		return NULL;
+	}
+	
+	/* Up to one sample per CPU each tick */
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	max_samples = (size_t)seconds * hz * (cpus > 0 ? cpus : 1);
+	if (max_samples > STACK_SAMPLER_MAX_SAMPLES)
+		max_samples = STACK_SAMPLER_MAX_SAMPLES;
+	
+	profile = calloc(1, sizeof(*profile));
+	if (!profile)
+		goto fail;
+	profile->samples = calloc(max_samples, sizeof(*profile->samples));
+	if (!profile->samples)
+		goto fail;
+	profile->max_samples = max_samples;
+	
+	/* The first backtrace() loads the unwinder, which the handler must not */
+	backtrace(prime, 4);
+	
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = sample_handler;
+	action.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	
+	atomic_store(&active_profile, profile);
+	if (sigaction(SIGPROF, &action, &old_action) < 0)
+		goto fail;
+	
+	timer.it_interval.tv_usec = 1000000 / hz;
+	timer.it_value = timer.it_interval;
+	if (setitimer(ITIMER_PROF, &timer, &old_timer) < 0) {
+		sigaction(SIGPROF, &old_action, NULL);
+		goto fail;
+	}
+	
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += seconds;
+	sleep_until(&end);
+	
+	/* Stop, then wait out the handlers that saw the profile */
+	setitimer(ITIMER_PROF, &old_timer, NULL);
+	atomic_store(&active_profile, NULL);
+	while (atomic_load(&handlers_running))
+		sched_yield();
+	sigaction(SIGPROF, &old_action, NULL);
+	
+	pthread_mutex_unlock(&capture_lock);
+	
+	if (symbolize(profile) < 0) {
+		stack_profile_free(profile);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return profile;
+	
+fail:
+	atomic_store(&active_profile, NULL);
+	pthread_mutex_unlock(&capture_lock);
+	if (profile)
+		free(profile->samples);
+	free(profile);
+	errno = ENOMEM;
+	return NULL;
+}
+
+uint64_t stack_profile_samples(const struct stack_profile *profile)
+{
+	return profile ? profile->count : 0;
+}
+
+uint64_t stack_profile_dropped(const struct stack_profile *profile)
+{
+	return profile ? atomic_load(&profile->dropped) : 0;
+}
+
+double stack_profile_share(const struct stack_profile *profile, const char *name)
+{
+	const uint32_t *stack;
+	uint64_t hits = 0;
+	bool *match;
+	size_t i;
+	
+	if (!profile || !name || !profile->count)
+		return 0;
+	
+	match = calloc(profile->num_names, sizeof(*match));
+	if (!match)
+		return 0;
+	for (i = 0; i < profile->num_names; i++)
+		match[i] = strstr(profile->names[i], name) != NULL;
+	
+	stack = profile->stacks;
+	for (i = 0; i < profile->count; i++) {
+		uint32_t depth = profile->samples[i].depth;
+		
+		for (uint32_t j = 0; j < depth; j++) {
+			if (match[stack[j]]) {
+				hits++;
+				break;
+			}
+		}
+		stack += depth;
+	}
+	
+	free(match);
+	return (double)hits * 100.0 / profile->count;
+}
+
+char *stack_profile_folded(const struct stack_profile *profile, size_t *len)
+{
+	struct fold_entry *entries;
+	const uint32_t *stack;
+	struct json_buf out;
+	size_t i, run;
+	
+	if (!profile)
+		return NULL;
+	
+	entries = malloc((profile->count ? profile->count : 1) * sizeof(*entries));
+	if (!entries || !json_buf_init(&out, 4096)) {
+		free(entries);
+		return NULL;
+	}
+	
+	stack = profile->stacks;
+	for (i = 0; i < profile->count; i++) {
+		entries[i].thread = profile->thread_names[i];
+		entries[i].stack = stack;
+		entries[i].depth = profile->samples[i].depth;
+		stack += entries[i].depth;
+	}
+	qsort(entries, profile->count, sizeof(*entries), compare_fold);
+	
+	/* One line per run of equal stacks */
+	for (i = 0; i < profile->count; i += run) {
+		for (run = 1; i + run < profile->count &&
+		     !compare_fold(&entries[i], &entries[i + run]); run++)
+			;
+		
+		json_buf_append_str(&out, entries[i].thread);
+		for (uint32_t j = 0; j < entries[i].depth; j++) {
+			json_buf_append_char(&out, ';');
+			json_buf_append_str(&out, profile->names[entries[i].stack[j]]);
+		}
+		json_buf_append_char(&out, ' ');
+		json_buf_append_u64(&out, run);
+		json_buf_append_char(&out, '\n');
+	}
+	free(entries);
+	
+	if (len)
+		*len = out.len;
+	return json_buf_detach(&out);
+}
+
+void stack_profile_free(struct stack_profile *profile)
+{
+	size_t i;
+	
+	if (!profile)
+		return;
+	
+	if (profile->names) {
+		for (i = 0; i < profile->num_names; i++)
+			free(profile->names[i]);
+		free(profile->names);
+	}
+	free((void *)profile->thread_names);
+	free(profile->stacks);
+	free(profile->samples);
+	free(profile);
+}
@@ -0,0 +1,390 @@
+/* startup_graph.c - Dependency ordered, parallel subsystem startup
+ *
+ * Dependencies are kept as a bitmask per phase. Workers take the lock,
+ * pick any wanted phase whose dependencies are all done, run it without
+ * the lock and wake the others when it finishes, until no wanted phase
+ * is left pending. Cycles are refused when a dependency is added, so a
+ * wanted phase always becomes runnable or is skipped.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "startup_graph.h"
+
+struct sg_phase {
+	const char *name;
+	startup_fn fn;
+	void *arg;
+	unsigned int flags;
+	uint32_t deps;                  /* Bit per phase this one needs */
+	bool wanted;                    /* Run, or started on demand */
+	enum startup_state state;
+	int result;
+	uint64_t start_ns;
+	uint64_t duration_ns;
+};
+
+struct startup_graph {
+	struct sg_phase phases[STARTUP_MAX_PHASES];
+	int count;
+	bool ran;                       /* startup_graph_run() was called */
+	uint64_t t0;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t threads[STARTUP_MAX_PHASES];  /* Started by startup_graph_start() */
+	int thread_count;
+};
+
+static uint64_t sg_now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Phases needed by a phase, directly or not */
+static uint32_t sg_closure(struct startup_graph *graph, int phase)
+{
+	uint32_t seen = 0, todo = graph->phases[phase].deps;
+	
+	while (todo) {
+		int i = __builtin_ctz(todo);
+		
+		todo &= todo - 1;
+		if (seen & (1U << i))
+			continue;
+		seen |= 1U << i;
+		todo |= graph->phases[i].deps & ~seen;
+	}
+	return seen;
+}
+
+/* Mark a phase and everything it needs as wanted, lock held. Returns
+ * whether anything was newly marked. */
+static bool sg_want(struct startup_graph *graph, int phase)
+{
+	uint32_t mask = sg_closure(graph, phase) | (1U << phase);
+	bool marked = false;
+	
+	while (mask) {
+		int i = __builtin_ctz(mask);
+		
+		mask &= mask - 1;
+		if (!graph->phases[i].wanted) {
+			graph->phases[i].wanted = true;
+			marked = true;
+		}
+	}
+	return marked;
+}
+
+/* Next runnable phase, skipping those whose dependencies cannot be met,
+ * lock held. Returns -1 if none is runnable right now. */
+static int sg_next(struct startup_graph *graph)
+{
+	bool changed;
+	
+	do {
+		changed = false;
+		for (int i = 0; i < graph->count; i++) {
+			struct sg_phase *p = &graph->phases[i];
+			uint32_t deps = p->deps;
+			bool ready = true;
+			
+			if (!p->wanted || p->state != STARTUP_PENDING)
+				continue;
+			
+			while (deps) {
+				enum startup_state s = graph->phases[__builtin_ctz(deps)].state;
+				
+				deps &= deps - 1;
+				if (s == STARTUP_FAILED || s == STARTUP_SKIPPED) {
+					p->state = STARTUP_SKIPPED;
+					changed = true;
+					ready = false;
+					break;
+				}
+				if (s != STARTUP_DONE)
+					ready = false;
+			}
+			if (ready)
+				return i;
+		}
+		if (changed)
+			pthread_cond_broadcast(&graph->cond);
+	} while (changed);
+	
+	return -1;
+}
+
+static bool sg_pending(struct startup_graph *graph)
+{
+	for (int i = 0; i < graph->count; i++)
+		if (graph->phases[i].wanted && graph->phases[i].state == STARTUP_PENDING)
+			return true;
+	return false;
+}
+
+static void *sg_worker(void *arg)
+{
+	struct startup_graph *graph = arg;
+	
+	pthread_mutex_lock(&graph->lock);
+	for (;;) {
+		struct sg_phase *p;
+		uint64_t start;
+		int id, ret;
+		
+		id = sg_next(graph);
+		if (id < 0) {
+			if (!sg_pending(graph))
+				break;
+			pthread_cond_wait(&graph->cond, &graph->lock);
+			continue;
+		}
+		
+		p = &graph->phases[id];
+		p->state = STARTUP_RUNNING;
+		start = sg_now();
+		p->start_ns = start - graph->t0;
+		pthread_mutex_unlock(&graph->lock);
+		
+		ret = p->fn(p->arg);
+		
+		pthread_mutex_lock(&graph->lock);
+		p->duration_ns = sg_now() - start;
+		p->result = ret;
+		p->state = ret < 0 ? STARTUP_FAILED : STARTUP_DONE;
+		pthread_cond_broadcast(&graph->cond);
+	}
+	pthread_mutex_unlock(&graph->lock);
+	
+	return NULL;
+}
+
+struct startup_graph *startup_graph_create(void)
+{
+	struct startup_graph *graph;
+	
+	graph = calloc(1, sizeof(*graph));
+	if (!graph)
+		return NULL;
+	
+	if (pthread_mutex_init(&graph->lock, NULL) != 0)
+		goto err_free;
+	if (pthread_cond_init(&graph->cond, NULL) != 0)
+		goto err_mutex;
+	graph->t0 = sg_now();
+	
+	return graph;
+	
+err_mutex:
+	pthread_mutex_destroy(&graph->lock);
+err_free:
+	free(graph);
+	return NULL;
+}
+
+void startup_graph_destroy(struct startup_graph *graph)
+{
+	if (!graph)
+		return;
+	
+	for (int i = 0; i < graph->thread_count; i++)
+		pthread_join(graph->threads[i], NULL);
+	
+	pthread_cond_destroy(&graph->cond);
+	pthread_mutex_destroy(&graph->lock);
+	free(graph);
+}
+
+int startup_graph_add(struct startup_graph *graph, const char *name,
+                      startup_fn fn, void *arg, unsigned int flags)
+{
+	struct sg_phase *p;
+	
+	if (!graph || !name || !fn)
+		return -EINVAL;
+	if (graph->ran)
+		return -EBUSY;
+	if (graph->count >= STARTUP_MAX_PHASES)
+		return -ENOSPC;
+	
+	p = &graph->phases[graph->count];
+	memset(p, 0, sizeof(*p));
+	p->name = name;
+	p->fn = fn;
+	p->arg = arg;
+	p->flags = flags;
+	p->state = STARTUP_PENDING;
+	
+	return graph->count++;
+}
+
+int startup_graph_depend(struct startup_graph *graph, int phase, int dep)
+{
+	if (!graph || phase < 0 || phase >= graph->count ||
+	    dep < 0 || dep >= graph->count)
+		return -EINVAL;
+	if (graph->ran)
+		return -EBUSY;
+	if (phase == dep || (sg_closure(graph, dep) & (1U << phase)))
+		return -ELOOP;
+	
+	graph->phases[phase].deps |= 1U << dep;
+	return 0;
+}
+
+int startup_graph_run(struct startup_graph *graph, unsigned int threads)
+{
+	pthread_t workers[STARTUP_MAX_PHASES];
+	unsigned int started = 0;
+	int ret = 0;
+	
+	if (!graph)
+		return -EINVAL;
+	
+	pthread_mutex_lock(&graph->lock);
+	if (graph->ran) {
+		pthread_mutex_unlock(&graph->lock);
+		return -EBUSY;
+	}
+	graph->ran = true;
+	graph->t0 = sg_now();
+	for (int i = 0; i < graph->count; i++)
+		if (!(graph->phases[i].flags & STARTUP_LAZY))
+			sg_want(graph, i);
+	pthread_mutex_unlock(&graph->lock);
+	
+	/* The calling thread is one of the workers, too few threads only
+	 * means less parallelism */
+	if (threads > (unsigned int)graph->count)
+		threads = graph->count;
+	while (started + 1 < threads &&
+	       pthread_create(&workers[started], NULL, sg_worker, graph) == 0)
+		started++;
+	
+	sg_worker(graph);
+	for (unsigned int i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+	
+	pthread_mutex_lock(&graph->lock);
+	for (int i = 0; i < graph->count && ret == 0; i++) {
+		struct sg_phase *p = &graph->phases[i];
+		
+		if (!(p->flags & STARTUP_REQUIRED) || (p->flags & STARTUP_LAZY))
+			continue;
+		if (p->state == STARTUP_FAILED)
+			ret = p->result;
+		else if (p->state == STARTUP_SKIPPED)
+			ret = -ECANCELED;
+	}
+	pthread_mutex_unlock(&graph->lock);
+	
+	return ret;
+}
+
+int startup_graph_start(struct startup_graph *graph, int phase)
+{
+	int ret = 0;
+	
+	if (!graph || phase < 0 || phase >= graph->count)
+		return -EINVAL;
+	
+	pthread_mutex_lock(&graph->lock);
+	if (sg_want(graph, phase) && graph->ran) {
+		ret = pthread_create(&graph->threads[graph->thread_count], NULL,
+		                     sg_worker, graph);
+		if (ret == 0)
+			graph->thread_count++;
+	}
+	pthread_cond_broadcast(&graph->cond);
+	pthread_mutex_unlock(&graph->lock);
+	
+	/* Without a thread of its own the phase runs on the caller */
+	if (ret != 0)
+		sg_worker(graph);
+	
+	return 0;
+}
+
+enum startup_state startup_graph_wait(struct startup_graph *graph, int phase)
+{
+	struct sg_phase *p;
+	enum startup_state state;
+	
+	if (!graph || phase < 0 || phase >= graph->count)
+		return STARTUP_SKIPPED;
+	
+	p = &graph->phases[phase];
+	pthread_mutex_lock(&graph->lock);
+	while (p->wanted && graph->ran &&
+	       (p->state == STARTUP_PENDING || p->state == STARTUP_RUNNING))
+		pthread_cond_wait(&graph->cond, &graph->lock);
+	state = p->state;
+	pthread_mutex_unlock(&graph->lock);
+	
+	return state;
+}
+
+enum startup_state startup_graph_state(struct startup_graph *graph, int phase)
+{
+	enum startup_state state;
+	
+	if (!graph || phase < 0 || phase >= graph->count)
+		return STARTUP_SKIPPED;
+	
+	pthread_mutex_lock(&graph->lock);
+	state = graph->phases[phase].state;
+	pthread_mutex_unlock(&graph->lock);
+	
+	return state;
+}
+
+int startup_graph_info(struct startup_graph *graph, int phase,
+                       struct startup_phase_info *info)
+{
+	struct sg_phase *p;
+	
+	if (!graph || !info || phase < 0 || phase >= graph->count)
+		return -EINVAL;
+	
+	p = &graph->phases[phase];
+	pthread_mutex_lock(&graph->lock);
+	info->name = p->name;
+	info->state = p->state;
+	info->result = p->result;
+	info->start_ns = p->start_ns;
+	info->duration_ns = p->duration_ns;
+	info->flags = p->flags;
+	pthread_mutex_unlock(&graph->lock);
+	
+	return 0;
+}
+
+int startup_graph_count(struct startup_graph *graph)
+{
+	return graph ? graph->count : 0;
+}
+
+const char *startup_state_name(enum startup_state state)
+{
+	switch (state) {
+	case STARTUP_PENDING:
+		return "pending";
+	case STARTUP_RUNNING:
+		return "running";
+	case STARTUP_DONE:
+		return "done";
+	case STARTUP_FAILED:
+		return "failed";
+	case STARTUP_SKIPPED:
+		return "skipped";
+	}
+	return "unknown";
+}
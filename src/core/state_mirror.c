@@ -0,0 +1,705 @@
+/* state_mirror.c - Current neighbor and connection tracking state
+ *
+ * Both mirrors are a bounded table of fixed size records, addressed by
+ * index and linked into a recency list, with an id_table from the hash of
+ * a record's key to its index. Keys are binary, the hash is seeded per
+ * table, and a record is only taken for its key after comparing the key
+ * itself.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/rtnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+
+#include "state_mirror.h"
+#include "nlmon_nl_route.h"
+#include "nlmon_nl_netfilter.h"
+#include "id_table.h"
+#include "sketch.h"
+#include "nlmon_clock.h"
+
+/* Index 0 is never handed out and stands for no record */
+#define STATE_NONE 0
+
+/* First allocation of the records, in records */
+#define STATE_MIN_CAPACITY 64
+
+/* Head of every record */
+struct state_link {
+	uint64_t hash;                   /* Hash of the key */
+	uint32_t prev;                   /* Updated more recently */
+	uint32_t next;                   /* Updated less recently */
+};
+
+/* Index entry, from the hash of a key to its record */
+struct state_index {
+	struct id_slot slot;
+	uint32_t record;
+};
+
+/* Bounded table of records, freed ones linked through their first four bytes */
+struct state_table {
+	struct id_table index;
+	char *records;
+	size_t record_size;
+	size_t key_offset;
+	size_t key_size;
+	uint32_t count;                  /* Records ever handed out, with index 0 */
+	uint32_t capacity;
+	uint32_t limit;                  /* Most records in use */
+	uint32_t free;
+	size_t used;
+	uint32_t head;                   /* Most recently updated */
+	uint32_t tail;                   /* Least recently updated */
+	uint64_t seed;
+	bool evict;                      /* Make room by evicting the tail when full */
+	uint64_t dropped;                /* Records turned away or evicted */
+};
+
+static inline void *record_at(struct state_table *t, uint32_t i)
+{
+	return t->records + (size_t)i * t->record_size;
+}
+
+static inline struct state_link *link_at(struct state_table *t, uint32_t i)
+{
+	return record_at(t, i);
+}
+
+static inline const void *record_key(struct state_table *t, uint32_t i)
+{
+	return (const char *)record_at(t, i) + t->key_offset;
+}
+
+static void table_init(struct state_table *t, size_t record_size, size_t key_offset,
+                       size_t key_size, size_t limit, bool evict)
+{
+	struct id_table index = ID_TABLE_INIT(struct state_index);
+	
+	memset(t, 0, sizeof(*t));
+	t->index = index;
+	t->record_size = record_size;
+	t->key_offset = key_offset;
+	t->key_size = key_size;
+	t->count = 1;
+	t->limit = limit < UINT32_MAX - 1 ? (uint32_t)limit : UINT32_MAX - 1;
+	t->evict = evict;
+	
+	/* Keys come from the network, so do not let them pick their slots */
+	t->seed = nlmon_clock_precise_ns() ^ ((uint64_t)(uintptr_t)t << 16);
+}
+
+static void table_free(struct state_table *t)
+{
+	id_table_free(&t->index);
+	free(t->records);
+	t->records = NULL;
+}
+
+static void lru_unlink(struct state_table *t, uint32_t i)
+{
+	struct state_link *l = link_at(t, i);
+	
+	if (l->prev != STATE_NONE)
+		link_at(t, l->prev)->next = l->next;
+	else
+		t->head = l->next;
+	if (l->next != STATE_NONE)
+		link_at(t, l->next)->prev = l->prev;
+	else
+		t->tail = l->prev;
+}
+
+static void lru_push(struct state_table *t, uint32_t i)
+{
+	struct state_link *l = link_at(t, i);
+	
+	l->prev = STATE_NONE;
+	l->next = t->head;
+	if (t->head != STATE_NONE)
+		link_at(t, t->head)->prev = i;
+	else
+		t->tail = i;
+	t->head = i;
+}
+
+static uint32_t table_find(struct state_table *t, const void *key)
+{
+	struct state_index *e = id_table_find(&t->index, sketch_hash(key, t->key_size, t->seed));
+	
+	if (!e || memcmp(record_key(t, e->record), key, t->key_size) != 0)
+		return STATE_NONE;
+	return e->record;
+}
+
+static void table_remove(struct state_table *t, uint32_t i)
+{
+	struct state_index *e = id_table_find(&t->index, link_at(t, i)->hash);
+	
+	if (e)
+		id_table_remove(&t->index, e);
+	lru_unlink(t, i);
+	memcpy(record_at(t, i), &t->free, sizeof(t->free));
+	t->free = i;
+	t->used--;
+}
+
+/* Record of a key, moved to the head of the recency list, or added zeroed
+ * but for its key. STATE_NONE with -ENOSPC or -ENOMEM in err on failure. */
+static uint32_t table_get(struct state_table *t, const void *key, bool *created, int *err)
+{
+	uint64_t hash = sketch_hash(key, t->key_size, t->seed);
+	struct state_index *e;
+	uint64_t capacity;
+	uint32_t i;
+	char *records;
+	int is_new;
+	
+	*created = false;
+	
+	e = id_table_find(&t->index, hash);
+	if (e) {
+		i = e->record;
+		if (memcmp(record_key(t, i), key, t->key_size) == 0) {
+			if (t->head != i) {
+				lru_unlink(t, i);
+				lru_push(t, i);
+			}
+			return i;
+		}
+		
+		/* Another key of the same hash, the newer one takes its place */
+		table_remove(t, i);
+		t->dropped++;
+	}
+	
+	if (t->used >= t->limit) {
+		if (!t->evict || t->tail == STATE_NONE) {
+			t->dropped++;
+			*err = -ENOSPC;
+			return STATE_NONE;
+		}
+		table_remove(t, t->tail);
+		t->dropped++;
+	}
+	
+	if (t->free == STATE_NONE && t->count >= t->capacity) {
+		capacity = t->capacity ? (uint64_t)t->capacity * 2 : STATE_MIN_CAPACITY;
+		if (capacity > (uint64_t)t->limit + 1)
+			capacity = (uint64_t)t->limit + 1;
+		
+		records = realloc(t->records, (size_t)capacity * t->record_size);
+		if (!records) {
+			*err = -ENOMEM;
+			return STATE_NONE;
+		}
+		t->records = records;
+		t->capacity = (uint32_t)capacity;
+	}
+	
+	e = id_table_get(&t->index, hash, &is_new);
+	if (!e) {
+		*err = -ENOMEM;
+		return STATE_NONE;
+	}
+	
+	if (t->free != STATE_NONE) {
+		i = t->free;
+		memcpy(&t->free, record_at(t, i), sizeof(t->free));
+	} else {
+		i = t->count++;
+	}
+	
+	memset(record_at(t, i), 0, t->record_size);
+	memcpy((char *)record_at(t, i) + t->key_offset, key, t->key_size);
+	link_at(t, i)->hash = hash;
+	e->record = i;
+	lru_push(t, i);
+	t->used++;
+	
+	*created = true;
+	return i;
+}
+
+/* Binary form of an address, the family taken from its text if 0 */
+static int parse_addr(int *family, const char *text, uint8_t *addr)
+{
+	memset(addr, 0, 16);
+	if (!text || !text[0])
+		return -EINVAL;
+	if (*family == 0)
+		*family = strchr(text, ':') ? AF_INET6 : AF_INET;
+	if ((*family != AF_INET && *family != AF_INET6) || inet_pton(*family, text, addr) != 1)
+		return -EINVAL;
+	return 0;
+}
+
+static bool lladdr_known(const unsigned char *lladdr)
+{
+	static const unsigned char zero[6];
+	
+	return memcmp(lladdr, zero, sizeof(zero)) != 0;
+}
+
+/* Neighbors */
+
+struct neigh_key {
+	int32_t ifindex;
+	uint8_t family;
+	uint8_t addr[16];
+};
+
+struct neigh_record {
+	struct state_link link;
+	struct neigh_key key;
+	unsigned char lladdr[6];
+	uint16_t state;
+	uint8_t flags;
+	time_t first_seen;
+	time_t updated;
+	time_t lladdr_changed;
+};
+
+struct neigh_mirror {
+	pthread_mutex_t lock;
+	struct state_table table;
+};
+
+static int neigh_key(struct neigh_key *key, int ifindex, int family, const char *addr)
+{
+	memset(key, 0, sizeof(*key));
+	if (parse_addr(&family, addr, key->addr) < 0)
+		return -EINVAL;
+	key->ifindex = ifindex;
+	key->family = (uint8_t)family;
+	return 0;
+}
+
+static void neigh_export(const struct neigh_record *r, struct neigh_mirror_entry *out)
+{
+	memset(out, 0, sizeof(*out));
+	out->family = r->key.family;
+	out->ifindex = r->key.ifindex;
+	inet_ntop(r->key.family, r->key.addr, out->dst, sizeof(out->dst));
+	memcpy(out->lladdr, r->lladdr, sizeof(out->lladdr));
+	out->state = r->state;
+	out->flags = r->flags;
+	out->first_seen = r->first_seen;
+	out->updated = r->updated;
+	out->lladdr_changed = r->lladdr_changed;
+}
+
+struct neigh_mirror *neigh_mirror_create(size_t max_entries)
+{
+	struct neigh_mirror *mirror;
+	
+	mirror = calloc(1, sizeof(*mirror));
+	if (!mirror)
+		return NULL;
+	
+	if (pthread_mutex_init(&mirror->lock, NULL) != 0) {
+		free(mirror);
+		return NULL;
+	}
+	
+	table_init(&mirror->table, sizeof(struct neigh_record), offsetof(struct neigh_record, key),
+	           sizeof(struct neigh_key), max_entries ? max_entries : NEIGH_MIRROR_DEFAULT_LIMIT,
+	           false);
+	return mirror;
+}
+
+void neigh_mirror_destroy(struct neigh_mirror *mirror)
+{
+	if (!mirror)
+		return;
+	
+	table_free(&mirror->table);
+	pthread_mutex_destroy(&mirror->lock);
+	free(mirror);
+}
+
+int neigh_mirror_update(struct neigh_mirror *mirror, uint16_t msg_type,
+                        const struct nlmon_neigh_info *neigh, time_t now,
+                        struct neigh_mirror_entry *prev)
+{
+	struct neigh_record *r;
+	struct neigh_key key;
+	bool created;
+	uint32_t i;
+	int ret = -EINVAL;
+	
+	if (!mirror || !neigh || (msg_type != RTM_NEWNEIGH && msg_type != RTM_DELNEIGH))
+		return -EINVAL;
+	if (neigh_key(&key, neigh->ifindex, neigh->family, neigh->dst) < 0)
+		return -EINVAL;
+	
+	pthread_mutex_lock(&mirror->lock);
+	
+	if (msg_type == RTM_DELNEIGH) {
+		i = table_find(&mirror->table, &key);
+		if (i == STATE_NONE) {
+			ret = -ENOENT;
+			goto out;
+		}
+		if (prev)
+			neigh_export(record_at(&mirror->table, i), prev);
+		table_remove(&mirror->table, i);
+		ret = 1;
+		goto out;
+	}
+	
+	i = table_get(&mirror->table, &key, &created, &ret);
+	if (i == STATE_NONE)
+		goto out;
+	
+	r = record_at(&mirror->table, i);
+	if (created) {
+		r->first_seen = now;
+		r->lladdr_changed = now;
+		ret = 0;
+	} else {
+		if (prev)
+			neigh_export(r, prev);
+		ret = 1;
+	}
+	
+	/* Unresolved and failed neighbors come without an address, keep the last one */
+	if (lladdr_known(neigh->lladdr) &&
+	    memcmp(r->lladdr, neigh->lladdr, sizeof(r->lladdr)) != 0) {
+		memcpy(r->lladdr, neigh->lladdr, sizeof(r->lladdr));
+		r->lladdr_changed = now;
+	}
+	r->state = neigh->state;
+	r->flags = neigh->flags;
+	r->updated = now;
+	
+out:
+	pthread_mutex_unlock(&mirror->lock);
+	return ret;
+}
+
+bool neigh_mirror_lookup(struct neigh_mirror *mirror, int ifindex, const char *addr,
+                         struct neigh_mirror_entry *out)
+{
+	struct neigh_key key;
+	uint32_t i;
+	
+	if (!mirror || !out || neigh_key(&key, ifindex, 0, addr) < 0)
+		return false;
+	
+	pthread_mutex_lock(&mirror->lock);
+	i = table_find(&mirror->table, &key);
+	if (i != STATE_NONE)
+		neigh_export(record_at(&mirror->table, i), out);
+	pthread_mutex_unlock(&mirror->lock);
+	
+	return i != STATE_NONE;
+}
+
+size_t neigh_mirror_walk(struct neigh_mirror *mirror, neigh_mirror_walk_fn fn, void *ctx)
+{
+	struct neigh_mirror_entry entry;
+	size_t visited = 0;
+	uint32_t i;
+	
+	if (!mirror || !fn)
+		return 0;
+	
+	pthread_mutex_lock(&mirror->lock);
+	for (i = mirror->table.head; i != STATE_NONE; i = link_at(&mirror->table, i)->next) {
+		neigh_export(record_at(&mirror->table, i), &entry);
+		visited++;
+		if (!fn(&entry, ctx))
+			break;
+	}
+	pthread_mutex_unlock(&mirror->lock);
+	
+	return visited;
+}
+
+int neigh_mirror_restore(struct neigh_mirror *mirror, const struct neigh_mirror_entry *entry)
+{
+	struct neigh_record *r;
+	struct neigh_key key;
+	bool created;
+	uint32_t i;
+	int ret = -EINVAL;
+	
+	if (!mirror || !entry)
+		return -EINVAL;
+	if (neigh_key(&key, entry->ifindex, entry->family, entry->dst) < 0)
+		return -EINVAL;
+	
+	pthread_mutex_lock(&mirror->lock);
+	
+	i = table_get(&mirror->table, &key, &created, &ret);
+	if (i != STATE_NONE) {
+		r = record_at(&mirror->table, i);
+		memcpy(r->lladdr, entry->lladdr, sizeof(r->lladdr));
+		r->state = entry->state;
+		r->flags = entry->flags;
+		r->first_seen = entry->first_seen;
+		r->updated = entry->updated;
+		r->lladdr_changed = entry->lladdr_changed;
+		ret = created ? 0 : 1;
+	}
+	
+	pthread_mutex_unlock(&mirror->lock);
+	return ret;
+}
+
+void neigh_mirror_stats(struct neigh_mirror *mirror, size_t *entries, uint64_t *rejected)
+{
+	if (!mirror)
+		return;
+	
+	pthread_mutex_lock(&mirror->lock);
+	if (entries)
+		*entries = mirror->table.used;
+	if (rejected)
+		*rejected = mirror->table.dropped;
+	pthread_mutex_unlock(&mirror->lock);
+}
+
+/* Connection tracking */
+
+struct ct_key {
+	uint8_t family;
+	uint8_t protocol;
+	uint16_t src_port;
+	uint16_t dst_port;
+	uint8_t src[16];
+	uint8_t dst[16];
+};
+
+struct ct_record {
+	struct state_link link;
+	struct ct_key key;
+	uint8_t tcp_state;
+	uint32_t mark;
+	uint64_t packets_orig;
+	uint64_t packets_reply;
+	uint64_t bytes_orig;
+	uint64_t bytes_reply;
+	time_t first_seen;
+	time_t updated;
+};
+
+struct ct_mirror {
+	pthread_mutex_t lock;
+	struct state_table table;
+};
+
+static int ct_key(struct ct_key *key, const struct nlmon_ct_info *ct)
+{
+	int family = 0;
+	
+	memset(key, 0, sizeof(*key));
+	if (parse_addr(&family, ct->src_addr, key->src) < 0 ||
+	    parse_addr(&family, ct->dst_addr, key->dst) < 0)
+		return -EINVAL;
+	key->family = (uint8_t)family;
+	key->protocol = ct->protocol;
+	key->src_port = ct->src_port;
+	key->dst_port = ct->dst_port;
+	return 0;
+}
+
+static void ct_export(const struct ct_record *r, struct ct_mirror_entry *out)
+{
+	memset(out, 0, sizeof(*out));
+	out->family = r->key.family;
+	out->protocol = r->key.protocol;
+	out->tcp_state = r->tcp_state;
+	inet_ntop(r->key.family, r->key.src, out->src_addr, sizeof(out->src_addr));
+	inet_ntop(r->key.family, r->key.dst, out->dst_addr, sizeof(out->dst_addr));
+	out->src_port = r->key.src_port;
+	out->dst_port = r->key.dst_port;
+	out->mark = r->mark;
+	out->packets_orig = r->packets_orig;
+	out->packets_reply = r->packets_reply;
+	out->bytes_orig = r->bytes_orig;
+	out->bytes_reply = r->bytes_reply;
+	out->first_seen = r->first_seen;
+	out->updated = r->updated;
+}
+
+struct ct_mirror *ct_mirror_create(size_t max_entries)
+{
+	struct ct_mirror *mirror;
+	
+	mirror = calloc(1, sizeof(*mirror));
+	if (!mirror)
+		return NULL;
+	
+	if (pthread_mutex_init(&mirror->lock, NULL) != 0) {
+		free(mirror);
+		return NULL;
+	}
+	
+	table_init(&mirror->table, sizeof(struct ct_record), offsetof(struct ct_record, key),
+	           sizeof(struct ct_key), max_entries ? max_entries : CT_MIRROR_DEFAULT_LIMIT,
+	           true);
+	return mirror;
+}
+
+void ct_mirror_destroy(struct ct_mirror *mirror)
+{
+	if (!mirror)
+		return;
+	
+	table_free(&mirror->table);
+	pthread_mutex_destroy(&mirror->lock);
+	free(mirror);
+}
+
+int ct_mirror_update(struct ct_mirror *mirror, uint16_t msg_type,
+                     const struct nlmon_ct_info *ct, time_t now)
+{
+	struct ct_record *r;
+	struct ct_key key;
+	bool created;
+	uint32_t i;
+	int ret = -EINVAL;
+	
+	if (!mirror || !ct || (msg_type != IPCTNL_MSG_CT_NEW && msg_type != IPCTNL_MSG_CT_DELETE))
+		return -EINVAL;
+	if (ct_key(&key, ct) < 0)
+		return -EINVAL;
+	
+	pthread_mutex_lock(&mirror->lock);
+	
+	if (msg_type == IPCTNL_MSG_CT_DELETE) {
+		i = table_find(&mirror->table, &key);
+		if (i == STATE_NONE) {
+			ret = -ENOENT;
+		} else {
+			table_remove(&mirror->table, i);
+			ret = 1;
+		}
+		goto out;
+	}
+	
+	i = table_get(&mirror->table, &key, &created, &ret);
+	if (i == STATE_NONE)
+		goto out;
+	
+	r = record_at(&mirror->table, i);
+	if (created)
+		r->first_seen = now;
+	ret = created ? 0 : 1;
+	
+	/* Counters only come with accounting enabled, keep the last ones seen */
+	r->tcp_state = ct->tcp_state;
+	r->mark = ct->mark;
+	if (ct->packets_orig || ct->packets_reply || ct->bytes_orig || ct->bytes_reply) {
+		r->packets_orig = ct->packets_orig;
+		r->packets_reply = ct->packets_reply;
+		r->bytes_orig = ct->bytes_orig;
+		r->bytes_reply = ct->bytes_reply;
+	}
+	r->updated = now;
+	
+out:
+	pthread_mutex_unlock(&mirror->lock);
+	return ret;
+}
+
+bool ct_mirror_lookup(struct ct_mirror *mirror, const struct nlmon_ct_info *tuple,
+                      struct ct_mirror_entry *out)
+{
+	struct ct_key key;
+	uint32_t i;
+	
+	if (!mirror || !tuple || !out || ct_key(&key, tuple) < 0)
+		return false;
+	
+	pthread_mutex_lock(&mirror->lock);
+	i = table_find(&mirror->table, &key);
+	if (i != STATE_NONE)
+		ct_export(record_at(&mirror->table, i), out);
+	pthread_mutex_unlock(&mirror->lock);
+	
+	return i != STATE_NONE;
+}
+
+size_t ct_mirror_walk(struct ct_mirror *mirror, ct_mirror_walk_fn fn, void *ctx)
+{
+	struct ct_mirror_entry entry;
+	size_t visited = 0;
+	uint32_t i;
+	
+	if (!mirror || !fn)
+		return 0;
+	
+	pthread_mutex_lock(&mirror->lock);
+	for (i = mirror->table.head; i != STATE_NONE; i = link_at(&mirror->table, i)->next) {
+		ct_export(record_at(&mirror->table, i), &entry);
+		visited++;
+		if (!fn(&entry, ctx))
+			break;
+	}
+	pthread_mutex_unlock(&mirror->lock);
+	
+	return visited;
+}
+
+int ct_mirror_restore(struct ct_mirror *mirror, const struct ct_mirror_entry *entry)
+{
+	struct ct_record *r;
+	struct ct_key key;
+	bool created;
+	int family = entry ? entry->family : 0;
+	uint32_t i;
+	int ret = -EINVAL;
+	
+	if (!mirror || !entry)
+		return -EINVAL;
+	
+	memset(&key, 0, sizeof(key));
+	if (parse_addr(&family, entry->src_addr, key.src) < 0 ||
+	    parse_addr(&family, entry->dst_addr, key.dst) < 0)
+		return -EINVAL;
+	key.family = (uint8_t)family;
+	key.protocol = entry->protocol;
+	key.src_port = entry->src_port;
+	key.dst_port = entry->dst_port;
+	
+	pthread_mutex_lock(&mirror->lock);
+	
+	i = table_get(&mirror->table, &key, &created, &ret);
+	if (i != STATE_NONE) {
+		r = record_at(&mirror->table, i);
+		r->tcp_state = entry->tcp_state;
+		r->mark = entry->mark;
+		r->packets_orig = entry->packets_orig;
+		r->packets_reply = entry->packets_reply;
+		r->bytes_orig = entry->bytes_orig;
+		r->bytes_reply = entry->bytes_reply;
+		r->first_seen = entry->first_seen;
+		r->updated = entry->updated;
+		ret = created ? 0 : 1;
+	}
+	
+	pthread_mutex_unlock(&mirror->lock);
+	return ret;
+}
+
+void ct_mirror_stats(struct ct_mirror *mirror, size_t *entries, uint64_t *evicted)
+{
+	if (!mirror)
+		return;
+	
+	pthread_mutex_lock(&mirror->lock);
+	if (entries)
+		*entries = mirror->table.used;
+	if (evicted)
+		*evicted = mirror->table.dropped;
+	pthread_mutex_unlock(&mirror->lock);
+}
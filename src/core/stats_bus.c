@@ -0,0 +1,266 @@
+/* stats_bus.c - Periodic snapshot of the pipeline's statistics
+ *
+ * Snapshots are published into two slots, each a sequence lock: the
+ * publisher collects into a private snapshot, copies it into the slot not
+ * published, with the slot's sequence odd meanwhile, and then makes that
+ * slot the current one. A reader copies the current slot and retries if
+ * its sequence was odd or changed, which takes two publications during
+ * one copy. Slots are copied a word at a time with relaxed atomics so the
+ * racing copy of a retried read is well defined.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "stats_bus.h"
+
+#define NS_PER_MS 1000000ULL
+#define SNAPSHOT_WORDS ((sizeof(struct nlmon_stats_snapshot) + 7) / 8)
+
+/* Snapshot as words, for copying into and out of a slot */
+union snapshot_words {
+	struct nlmon_stats_snapshot snapshot;
+	uint64_t words[SNAPSHOT_WORDS];
+};
+
+struct snapshot_slot {
+	_Atomic uint64_t seq;           /* Odd while written */
+	_Atomic uint64_t words[SNAPSHOT_WORDS];
+};
+
+struct stats_source {
+	stats_bus_collect_fn collect;
+	void *ctx;
+};
+
+struct stats_subscriber {
+	stats_bus_notify_fn notify;
+	void *ctx;
+};
+
+struct stats_bus {
+	struct snapshot_slot slots[2];
+	_Atomic unsigned int current;   /* Slot of the latest snapshot */
+	_Atomic uint64_t generation;
+	
+	struct stats_source sources[STATS_BUS_MAX_SOURCES];
+	size_t num_sources;
+	struct stats_subscriber subscribers[STATS_BUS_MAX_SUBSCRIBERS];
+	size_t num_subscribers;
+	
+	/* Publishers, the bus thread and stats_bus_publish() callers */
+	pthread_mutex_t publish_lock;
+	union snapshot_words scratch;
+	
+	unsigned int interval_ms;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool started;
+	bool running;
+};
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct stats_bus *stats_bus_create(unsigned int interval_ms)
+{
+	struct stats_bus *bus;
+	pthread_condattr_t attr;
+	
+	bus = calloc(1, sizeof(*bus));
+	if (!bus)
+		return NULL;
+	
+	bus->interval_ms = interval_ms ? interval_ms : STATS_BUS_DEFAULT_INTERVAL_MS;
+	
+	/* Deadlines are on the monotonic clock */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&bus->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&bus->lock, NULL);
+	pthread_mutex_init(&bus->publish_lock, NULL);
+	
+	return bus;
+}
+
+int stats_bus_add_source(struct stats_bus *bus, stats_bus_collect_fn collect, void *ctx)
+{
+	if (!bus || !collect || bus->started || bus->num_sources == STATS_BUS_MAX_SOURCES)
+		return -1;
+	
+	bus->sources[bus->num_sources].collect = collect;
+	bus->sources[bus->num_sources].ctx = ctx;
+	bus->num_sources++;
+	return 0;
+}
+
+int stats_bus_subscribe(struct stats_bus *bus, stats_bus_notify_fn notify, void *ctx)
+{
+	if (!bus || !notify || bus->started || bus->num_subscribers == STATS_BUS_MAX_SUBSCRIBERS)
+		return -1;
+	
+	bus->subscribers[bus->num_subscribers].notify = notify;
+	bus->subscribers[bus->num_subscribers].ctx = ctx;
+	bus->num_subscribers++;
+	return 0;
+}
+
+void stats_bus_publish(struct stats_bus *bus)
+{
+	struct nlmon_stats_snapshot *snapshot;
+	struct snapshot_slot *slot;
+	struct timespec now;
+	unsigned int next;
+	uint64_t seq, start;
+	size_t i;
+	
+	if (!bus)
+		return;
+	
+	pthread_mutex_lock(&bus->publish_lock);
+	
+	/* Collect, with no reader watching */
+	snapshot = &bus->scratch.snapshot;
+	memset(&bus->scratch, 0, sizeof(bus->scratch));
+	clock_gettime(CLOCK_REALTIME, &now);
+	snapshot->timestamp_ms = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / NS_PER_MS;
+	start = monotonic_ns();
+	for (i = 0; i < bus->num_sources; i++)
+		bus->sources[i].collect(snapshot, bus->sources[i].ctx);
+	snapshot->collect_ns = monotonic_ns() - start;
+	snapshot->generation = atomic_load_explicit(&bus->generation, memory_order_relaxed) + 1;
+	
+	/* Into the slot readers are not on */
+	next = atomic_load_explicit(&bus->current, memory_order_relaxed) ^ 1;
+	slot = &bus->slots[next];
+	seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	for (i = 0; i < SNAPSHOT_WORDS; i++)
+		atomic_store_explicit(&slot->words[i], bus->scratch.words[i], memory_order_relaxed);
+	atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+	
+	atomic_store_explicit(&bus->current, next, memory_order_release);
+	atomic_store_explicit(&bus->generation, snapshot->generation, memory_order_release);
+	
+	for (i = 0; i < bus->num_subscribers; i++)
+		bus->subscribers[i].notify(snapshot, bus->subscribers[i].ctx);
+	
+	pthread_mutex_unlock(&bus->publish_lock);
+}
+
+bool stats_bus_read(struct stats_bus *bus, struct nlmon_stats_snapshot *snapshot)
+{
+	union snapshot_words copy;
+	
+	if (!bus || !snapshot ||
+	    !atomic_load_explicit(&bus->generation, memory_order_acquire))
+		return false;
+	
+	for (;;) {
+		unsigned int current = atomic_load_explicit(&bus->current, memory_order_acquire);
+		struct snapshot_slot *slot = &bus->slots[current];
+		uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		size_t i;
+		
+		if (seq & 1)
+			continue;
+		
+		for (i = 0; i < SNAPSHOT_WORDS; i++)
+			copy.words[i] = atomic_load_explicit(&slot->words[i], memory_order_relaxed);
+		
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq)
+			break;
+	}
+	
+	*snapshot = copy.snapshot;
+	return true;
+}
+
+uint64_t stats_bus_generation(struct stats_bus *bus)
+{
+	return bus ? atomic_load_explicit(&bus->generation, memory_order_acquire) : 0;
+}
+
+static void *bus_thread(void *arg)
+{
+	struct stats_bus *bus = arg;
+	struct timespec deadline;
+	uint64_t next;
+	
+	next = monotonic_ns();
+	
+	pthread_mutex_lock(&bus->lock);
+	while (bus->running) {
+		/* On a fixed beat, however long collecting took */
+		next += bus->interval_ms * NS_PER_MS;
+		deadline.tv_sec = next / 1000000000ULL;
+		deadline.tv_nsec = next % 1000000000ULL;
+		
+		while (bus->running &&
+		       pthread_cond_timedwait(&bus->cond, &bus->lock, &deadline) != ETIMEDOUT)
+			;
+		if (!bus->running)
+			break;
+		
+		pthread_mutex_unlock(&bus->lock);
+		stats_bus_publish(bus);
+		pthread_mutex_lock(&bus->lock);
+		
+		/* A stall skips the beats it missed rather than catching up */
+		if (monotonic_ns() > next + bus->interval_ms * NS_PER_MS)
+			next = monotonic_ns();
+	}
+	pthread_mutex_unlock(&bus->lock);
+	
+	return NULL;
+}
+
+int stats_bus_start(struct stats_bus *bus)
+{
+	if (!bus || bus->started)
+		return -1;
+	
+	bus->started = true;
+	stats_bus_publish(bus);
+	
+	bus->running = true;
+	if (pthread_create(&bus->thread, NULL, bus_thread, bus) != 0) {
+		bus->running = false;
+		return -1;
+	}
+	return 0;
+}
+
+void stats_bus_destroy(struct stats_bus *bus)
+{
+	bool running;
+	
+	if (!bus)
+		return;
+	
+	pthread_mutex_lock(&bus->lock);
+	running = bus->running;
+	bus->running = false;
+	pthread_cond_signal(&bus->cond);
+	pthread_mutex_unlock(&bus->lock);
+	
+	if (running)
+		pthread_join(bus->thread, NULL);
+	
+	pthread_cond_destroy(&bus->cond);
+	pthread_mutex_destroy(&bus->lock);
+	pthread_mutex_destroy(&bus->publish_lock);
+	free(bus);
+}
@@ -0,0 +1,194 @@
+/* thread_affinity.c - CPU pinning, NUMA placement and naming of threads
+ *
+ * NUMA placement uses the set_mempolicy system call directly, so no
+ * libnuma is needed; on kernels without NUMA support it fails quietly.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "thread_affinity.h"
+
+/* Memory policy mode, see set_mempolicy(2) */
+#define TA_MPOL_PREFERRED 1
+
+/* Bits per node mask word */
+#define TA_MASK_BITS (8 * sizeof(unsigned long))
+
+/* Parse one non-negative CPU number, advances *p */
+static int ta_parse_cpu(const char **p)
+{
+	long cpu;
+	char *end;
+	
+	while (isspace((unsigned char)**p))
+		(*p)++;
+	
+	if (!isdigit((unsigned char)**p))
+		return -1;
+	
+	errno = 0;
+	cpu = strtol(*p, &end, 10);
+	if (errno || cpu >= CPU_SETSIZE)
+		return -1;
+	
+	*p = end;
+	while (isspace((unsigned char)**p))
+		(*p)++;
+	
+	return (int)cpu;
+}
+
+int thread_affinity_parse(const char *cpus, int *out, int max)
+{
+	const char *p = cpus;
+	int count = 0;
+	int first, last, cpu;
+	
+	if (!cpus)
+		return 0;
+	
+	while (isspace((unsigned char)*p))
+		p++;
+	if (*p == '\0')
+		return 0;
+	
+	for (;;) {
+		first = ta_parse_cpu(&p);
+		if (first < 0)
+			return -1;
+		
+		last = first;
+		if (*p == '-') {
+			p++;
+			last = ta_parse_cpu(&p);
+			if (last < first)
+				return -1;
+		}
+		
+		for (cpu = first; cpu <= last; cpu++) {
+			if (out && count < max)
+				out[count] = cpu;
+			count++;
+		}
+		
+		if (*p == '\0')
+			return count;
+		if (*p != ',')
+			return -1;
+		p++;
+	}
+}
+
+bool thread_affinity_valid(const char *cpus)
+{
+	return thread_affinity_parse(cpus, NULL, 0) >= 0;
+}
+
+int thread_affinity_apply(pthread_t thread, const char *cpus, int index,
+                          const char *name)
+{
+	int list[CPU_SETSIZE];
+	cpu_set_t set;
+	int count, i;
+	int pinned = -1;
+	
+	if (name) {
+		char buf[THREAD_NAME_MAX + 1];
+		
+		snprintf(buf, sizeof(buf), "%s", name);
+		pthread_setname_np(thread, buf);
+	}
+	
+	count = thread_affinity_parse(cpus, list, CPU_SETSIZE);
+	if (count <= 0)
+		return -1;
+	if (count > CPU_SETSIZE)
+		count = CPU_SETSIZE;
+	
+	CPU_ZERO(&set);
+	if (index >= 0) {
+		pinned = list[index % count];
+		CPU_SET(pinned, &set);
+	} else {
+		for (i = 0; i < count; i++)
+			CPU_SET(list[i], &set);
+	}
+	
+	if (pthread_setaffinity_np(thread, sizeof(set), &set) != 0)
+		return -1;
+	
+	return pinned;
+}
+
+int thread_affinity_node(const char *cpus)
+{
+	char path[64];
+	struct dirent *entry;
+	DIR *dir;
+	int cpu, node = -1;
+	
+	if (thread_affinity_parse(cpus, &cpu, 1) <= 0)
+		return -1;
+	
+	/* Each CPU directory links to its node as nodeN */
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	dir = opendir(path);
+	if (!dir)
+		return -1;
+	
+	while ((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name, "node", 4) == 0 &&
+		    isdigit((unsigned char)entry->d_name[4])) {
+			node = atoi(entry->d_name + 4);
+			break;
+		}
+	}
+	
+	closedir(dir);
+	return node;
+}
+
+int thread_affinity_prefer_node(int node, struct thread_mempolicy *saved)
+{
+	unsigned long mask[THREAD_MAX_NODES / TA_MASK_BITS];
+	
+	saved->valid = false;
+	
+	if (node < 0 || node >= THREAD_MAX_NODES)
+		return -EINVAL;
+	
+	if (syscall(SYS_get_mempolicy, &saved->mode, saved->nodemask,
+	            (unsigned long)THREAD_MAX_NODES, NULL, 0UL) < 0)
+		return -errno;
+	
+	memset(mask, 0, sizeof(mask));
+	mask[node / TA_MASK_BITS] |= 1UL << (node % TA_MASK_BITS);
+	
+	/* The kernel reads maxnode - 1 bits */
+	if (syscall(SYS_set_mempolicy, TA_MPOL_PREFERRED, mask,
+	            (unsigned long)THREAD_MAX_NODES + 1) < 0)
+		return -errno;
+	
+	saved->valid = true;
+	return 0;
+}
+
+void thread_affinity_restore(const struct thread_mempolicy *saved)
+{
+	if (!saved || !saved->valid)
+		return;
+	
+	syscall(SYS_set_mempolicy, saved->mode, saved->nodemask,
+	        (unsigned long)THREAD_MAX_NODES + 1);
+}
@@ -2,26 +2,108 @@
  *
  * Implements a thread pool with configurable size, work queue with priority
  * support, and graceful shutdown mechanism.
+ *
+ * In work-stealing mode every worker owns a Chase-Lev deque for work
+ * submitted from inside the pool and a small locked inbox for work
+ * submitted from outside. Idle workers steal from the other workers'
+ * deques and inboxes before parking.
+ *
+ * An elastic shared-queue pool starts workers while queued work waits
+ * longer than the target and lets workers go after a sustained idle
+ * period. Both decisions are spaced out so the pool does not oscillate.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <stdatomic.h>
 #include "thread_pool.h"
+#include "thread_affinity.h"
+#include "pipeline_watchdog.h"
+
+/* Per-worker deque capacity in work-stealing mode (power of two) */
+#define TP_DEQUE_SIZE 1024
 
 /* Work item structure */
 struct work_item {
 	work_func_t func;
 	void *arg;
 	enum work_priority priority;
+	uint64_t enqueued_ns;             /* Submission time, elastic pools only */
 	struct work_item *next;
 };
 
+/* Shared-queue worker thread slot */
+enum tp_slot_state {
+	TP_SLOT_EMPTY = 0,
+	TP_SLOT_RUNNING,
+	TP_SLOT_EXITED,                   /* Retired, waiting to be joined */
+};
+
+struct tp_slot {
+	struct thread_pool *pool;
+	size_t index;
+	enum tp_slot_state state;
+};
+
+/* Lock-free work-stealing deque, the owner pushes and pops at the bottom */
+struct tp_deque {
+	_Atomic int64_t top;
+	char pad[64];                     /* Thieves and owner on separate lines */
+	_Atomic int64_t bottom;
+	_Atomic(struct work_item *) slots[TP_DEQUE_SIZE];
+};
+
+/* Worker state in work-stealing mode */
+struct tp_worker {
+	struct thread_pool *pool;
+	size_t index;
+	struct tp_deque deque;
+	
+	/* Work submitted from outside the pool */
+	pthread_mutex_t inbox_mutex;
+	struct work_item *inbox_head[PRIORITY_MAX];
+	struct work_item *inbox_tail[PRIORITY_MAX];
+	atomic_size_t inbox_size;
+	
+	/* Statistics */
+	atomic_ulong steals;
+	atomic_ulong parks;
+	char pad[64];
+};
+
 /* Thread pool structure */
 struct thread_pool {
 	pthread_t *threads;
-	size_t num_threads;
+	size_t num_threads;               /* Running workers, under queue_mutex when elastic */
+	size_t capacity;                  /* Entries in threads and slots */
+	enum thread_pool_mode mode;
+	struct tp_slot *slots;            /* Shared-queue mode only */
+	char name[24];
+	char *cpus;
+	
+	/* Elastic sizing, all under queue_mutex */
+	bool elastic;
+	size_t min_threads;
+	size_t idle_workers;              /* Workers waiting for work */
+	uint64_t target_wait_ns;
+	uint64_t idle_ns;
+	uint64_t wait_ewma_ns;            /* Smoothed queue wait of started items */
+	uint64_t last_resize_ns;
+	unsigned long grown;
+	unsigned long shrunk;
+	
+	/* Work-stealing mode, the queue below is unused */
+	struct tp_worker *workers;
+	atomic_size_t pending;            /* Queued and not yet started */
+	atomic_size_t parked;             /* Workers waiting for work */
+	atomic_size_t waiters;            /* Callers in thread_pool_wait() */
+	atomic_size_t next_worker;        /* Round-robin start for placement */
 	
 	/* Work queue (priority-based) */
 	struct work_item *queue_head[PRIORITY_MAX];
@@ -45,6 +127,9 @@ struct thread_pool {
 	atomic_ulong rejected_count;
 };
 
+/* Worker running on the current thread, NULL outside work-stealing pools */
+static __thread struct tp_worker *tp_current;
+
 /* Get number of CPU cores */
 static size_t get_cpu_count(void)
 {
@@ -54,20 +139,92 @@ static size_t get_cpu_count(void)
 	return (size_t)nprocs;
 }
 
+static uint64_t tp_now_ns(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static bool tp_stopping(struct thread_pool *pool)
+{
+	return atomic_load_explicit(&pool->shutdown, memory_order_acquire) ||
+	       atomic_load_explicit(&pool->immediate_shutdown, memory_order_acquire);
+}
+
+/* Idle long enough and nothing resized lately */
+static bool tp_should_retire(struct thread_pool *pool, uint64_t now)
+{
+	return pool->queue_size == 0 &&
+	       pool->num_threads > pool->min_threads &&
+	       now - pool->last_resize_ns >= pool->idle_ns;
+}
+
+/* Wait for work in an elastic pool, false when the worker should retire */
+static bool tp_idle_wait(struct thread_pool *pool, struct tp_slot *slot)
+{
+	uint64_t deadline = tp_now_ns() + pool->idle_ns;
+	struct timespec ts;
+	uint64_t now;
+	
+	pool->idle_workers++;
+	while (pool->queue_size == 0 && !tp_stopping(pool)) {
+		ts.tv_sec = (time_t)(deadline / 1000000000ULL);
+		ts.tv_nsec = (long)(deadline % 1000000000ULL);
+		if (pthread_cond_timedwait(&pool->work_available, &pool->queue_mutex,
+		                           &ts) != ETIMEDOUT)
+			continue;
+		
+		now = tp_now_ns();
+		if (tp_should_retire(pool, now)) {
+			pool->idle_workers--;
+			pool->num_threads--;
+			pool->shrunk++;
+			pool->last_resize_ns = now;
+			slot->state = TP_SLOT_EXITED;
+			return false;
+		}
+		deadline = now + pool->idle_ns;
+	}
+	pool->idle_workers--;
+	
+	return true;
+}
+
+static bool tp_replace_worker(void *ctx);
+
+/* Watch the calling worker, a stalled one in an elastic pool is replaced */
+static void tp_watch(struct thread_pool *pool, size_t index)
+{
+	char name[48];
+	
+	snprintf(name, sizeof(name), "%s-%zu", pool->name, index);
+	nlmon_heartbeat_register(name, pool->elastic ? tp_replace_worker : NULL, pool);
+}
+
 /* Worker thread function */
 static void *worker_thread(void *arg)
 {
-	struct thread_pool *pool = arg;
+	struct tp_slot *slot = arg;
+	struct thread_pool *pool = slot->pool;
 	struct work_item *work;
 	int priority;
 	
+	tp_watch(pool, slot->index);
+	
 	while (1) {
 		pthread_mutex_lock(&pool->queue_mutex);
 		
 		/* Wait for work or shutdown */
-		while (pool->queue_size == 0 && 
-		       !atomic_load_explicit(&pool->shutdown, memory_order_acquire)) {
-			pthread_cond_wait(&pool->work_available, &pool->queue_mutex);
+		if (pool->elastic) {
+			if (!tp_idle_wait(pool, slot)) {
+				pthread_mutex_unlock(&pool->queue_mutex);
+				break;
+			}
+		} else {
+			while (pool->queue_size == 0 && !tp_stopping(pool))
+				pthread_cond_wait(&pool->work_available, &pool->queue_mutex);
 		}
 		
 		/* Check for shutdown */
@@ -95,13 +252,22 @@ static void *worker_thread(void *arg)
 			}
 		}
 		
+		/* Smoothed over 8 items, grows and shrinks react to trends */
+		if (work && pool->elastic) {
+			uint64_t wait = tp_now_ns() - work->enqueued_ns;
+			
+			pool->wait_ewma_ns += ((int64_t)wait - (int64_t)pool->wait_ewma_ns) / 8;
+		}
+		
 		pthread_mutex_unlock(&pool->queue_mutex);
 		
 		/* Execute work */
 		if (work) {
 			atomic_fetch_add_explicit(&pool->active_threads, 1, memory_order_relaxed);
 			
+			nlmon_heartbeat_enter("task");
 			work->func(work->arg);
+			nlmon_heartbeat_leave(NULL);
 			free(work);
 			
 			atomic_fetch_sub_explicit(&pool->active_threads, 1, memory_order_relaxed);
@@ -114,36 +280,497 @@ static void *worker_thread(void *arg)
 		}
 	}
 	
+	nlmon_heartbeat_unregister();
+	return NULL;
+}
+
+static bool tp_deque_push(struct tp_deque *dq, struct work_item *work)
+{
+	int64_t b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+	int64_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+	
+	if (b - t >= TP_DEQUE_SIZE)
+		return false;
+	
+	atomic_store_explicit(&dq->slots[b & (TP_DEQUE_SIZE - 1)], work, memory_order_relaxed);
+	
+	/* Publishes the slot and the work item to thieves */
+	atomic_store_explicit(&dq->bottom, b + 1, memory_order_release);
+	return true;
+}
+
+static struct work_item *tp_deque_pop(struct tp_deque *dq)
+{
+	int64_t b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+	int64_t t;
+	struct work_item *work;
+	
+	atomic_store_explicit(&dq->bottom, b, memory_order_release);
+	atomic_thread_fence(memory_order_seq_cst);
+	t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+	
+	if (t > b) {
+		/* Empty */
+		atomic_store_explicit(&dq->bottom, b + 1, memory_order_release);
+		return NULL;
+	}
+	
+	work = atomic_load_explicit(&dq->slots[b & (TP_DEQUE_SIZE - 1)], memory_order_relaxed);
+	if (t == b) {
+		/* Last item, race the thieves for it */
+		if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+		                                             memory_order_seq_cst,
+		                                             memory_order_relaxed))
+			work = NULL;
+		atomic_store_explicit(&dq->bottom, b + 1, memory_order_release);
+	}
+	
+	return work;
+}
+
+static struct work_item *tp_deque_steal(struct tp_deque *dq)
+{
+	int64_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+	int64_t b;
+	struct work_item *work;
+	
+	atomic_thread_fence(memory_order_seq_cst);
+	b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+	if (t >= b)
+		return NULL;
+	
+	work = atomic_load_explicit(&dq->slots[t & (TP_DEQUE_SIZE - 1)], memory_order_relaxed);
+	
+	/* Lost to the owner or another thief */
+	if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+	                                             memory_order_seq_cst,
+	                                             memory_order_relaxed))
+		return NULL;
+	
+	return work;
+}
+
+static size_t tp_worker_load(struct tp_worker *w)
+{
+	int64_t b = atomic_load_explicit(&w->deque.bottom, memory_order_relaxed);
+	int64_t t = atomic_load_explicit(&w->deque.top, memory_order_relaxed);
+	
+	return (b > t ? (size_t)(b - t) : 0) +
+	       atomic_load_explicit(&w->inbox_size, memory_order_relaxed);
+}
+
+static void tp_inbox_push(struct tp_worker *w, struct work_item *work)
+{
+	pthread_mutex_lock(&w->inbox_mutex);
+	
+	if (w->inbox_tail[work->priority])
+		w->inbox_tail[work->priority]->next = work;
+	else
+		w->inbox_head[work->priority] = work;
+	w->inbox_tail[work->priority] = work;
+	atomic_fetch_add_explicit(&w->inbox_size, 1, memory_order_relaxed);
+	
+	pthread_mutex_unlock(&w->inbox_mutex);
+}
+
+/* Take the highest priority inbox item, thieves do not wait for the lock */
+static struct work_item *tp_inbox_take(struct tp_worker *w, bool steal)
+{
+	struct work_item *work = NULL;
+	int priority;
+	
+	if (atomic_load_explicit(&w->inbox_size, memory_order_relaxed) == 0)
+		return NULL;
+	
+	if (steal) {
+		if (pthread_mutex_trylock(&w->inbox_mutex) != 0)
+			return NULL;
+	} else {
+		pthread_mutex_lock(&w->inbox_mutex);
+	}
+	
+	for (priority = PRIORITY_MAX - 1; priority >= 0; priority--) {
+		if (w->inbox_head[priority]) {
+			work = w->inbox_head[priority];
+			w->inbox_head[priority] = work->next;
+			if (!w->inbox_head[priority])
+				w->inbox_tail[priority] = NULL;
+			atomic_fetch_sub_explicit(&w->inbox_size, 1, memory_order_relaxed);
+			break;
+		}
+	}
+	
+	pthread_mutex_unlock(&w->inbox_mutex);
+	
+	return work;
+}
+
+/* Own deque first, then own inbox, then steal from the other workers */
+static struct work_item *ws_find_work(struct thread_pool *pool, struct tp_worker *self)
+{
+	struct work_item *work;
+	size_t i;
+	
+	work = tp_deque_pop(&self->deque);
+	if (!work)
+		work = tp_inbox_take(self, false);
+	if (work)
+		return work;
+	
+	for (i = 1; i < pool->num_threads; i++) {
+		struct tp_worker *victim = &pool->workers[(self->index + i) % pool->num_threads];
+		
+		work = tp_deque_steal(&victim->deque);
+		if (!work)
+			work = tp_inbox_take(victim, true);
+		if (work) {
+			atomic_fetch_add_explicit(&self->steals, 1, memory_order_relaxed);
+			return work;
+		}
+	}
+	
+	return NULL;
+}
+
+/* Sleep until work is pending, false when the worker should exit */
+static bool ws_park(struct thread_pool *pool, struct tp_worker *self)
+{
+	bool run = true;
+	
+	pthread_mutex_lock(&pool->queue_mutex);
+	
+	/* Pairs with the pending/parked check in ws_submit() */
+	atomic_fetch_add(&pool->parked, 1);
+	while (atomic_load(&pool->pending) == 0) {
+		if (atomic_load_explicit(&pool->shutdown, memory_order_acquire) ||
+		    atomic_load_explicit(&pool->immediate_shutdown, memory_order_acquire)) {
+			run = false;
+			break;
+		}
+		atomic_fetch_add_explicit(&self->parks, 1, memory_order_relaxed);
+		pthread_cond_wait(&pool->work_available, &pool->queue_mutex);
+	}
+	atomic_fetch_sub(&pool->parked, 1);
+	
+	pthread_mutex_unlock(&pool->queue_mutex);
+	
+	return run;
+}
+
+/* Worker thread function in work-stealing mode */
+static void *ws_worker_thread(void *arg)
+{
+	struct tp_worker *self = arg;
+	struct thread_pool *pool = self->pool;
+	struct work_item *work;
+	
+	tp_current = self;
+	tp_watch(pool, self->index);
+	
+	while (!atomic_load_explicit(&pool->immediate_shutdown, memory_order_acquire)) {
+		work = ws_find_work(pool, self);
+		if (!work) {
+			if (!ws_park(pool, self))
+				break;
+			continue;
+		}
+		
+		/* Active before no longer pending, see thread_pool_wait() */
+		atomic_fetch_add(&pool->active_threads, 1);
+		atomic_fetch_sub(&pool->pending, 1);
+		
+		nlmon_heartbeat_enter("task");
+		work->func(work->arg);
+		nlmon_heartbeat_leave(NULL);
+		free(work);
+		
+		atomic_fetch_add_explicit(&pool->completed_count, 1, memory_order_relaxed);
+		atomic_fetch_sub(&pool->active_threads, 1);
+		
+		/* Signal work done, only if someone waits */
+		if (atomic_load(&pool->waiters) > 0) {
+			pthread_mutex_lock(&pool->queue_mutex);
+			pthread_cond_broadcast(&pool->work_done);
+			pthread_mutex_unlock(&pool->queue_mutex);
+		}
+	}
+	
+	nlmon_heartbeat_unregister();
+	tp_current = NULL;
 	return NULL;
 }
 
+static bool ws_submit(struct thread_pool *pool, struct work_item *work)
+{
+	struct tp_worker *target;
+	size_t pending, i, start, best_load;
+	
+	/* Reserve a queue slot */
+	pending = atomic_load_explicit(&pool->pending, memory_order_relaxed);
+	do {
+		if (pool->max_queue_size > 0 && pending >= pool->max_queue_size)
+			return false;
+	} while (!atomic_compare_exchange_weak(&pool->pending, &pending, pending + 1));
+	
+	/* Work spawned by a worker stays local unless its deque is full */
+	if (!tp_current || tp_current->pool != pool ||
+	    !tp_deque_push(&tp_current->deque, work)) {
+		target = tp_current && tp_current->pool == pool ? tp_current : NULL;
+		
+		/* Otherwise place it with the least loaded worker */
+		if (!target) {
+			start = atomic_fetch_add_explicit(&pool->next_worker, 1,
+			                                  memory_order_relaxed) % pool->num_threads;
+			target = &pool->workers[start];
+			best_load = tp_worker_load(target);
+			for (i = 1; i < pool->num_threads && best_load > 0; i++) {
+				struct tp_worker *w = &pool->workers[(start + i) % pool->num_threads];
+				size_t load = tp_worker_load(w);
+				
+				if (load < best_load) {
+					target = w;
+					best_load = load;
+				}
+			}
+		}
+		
+		tp_inbox_push(target, work);
+	}
+	
+	atomic_fetch_add_explicit(&pool->submitted_count, 1, memory_order_relaxed);
+	
+	/* Wake a parked worker, pairs with ws_park() */
+	if (atomic_load(&pool->parked) > 0) {
+		pthread_mutex_lock(&pool->queue_mutex);
+		pthread_cond_signal(&pool->work_available);
+		pthread_mutex_unlock(&pool->queue_mutex);
+	}
+	
+	return true;
+}
+
+/* Free work items left in the workers' deques and inboxes */
+static void ws_destroy_workers(struct thread_pool *pool, size_t count)
+{
+	struct work_item *work, *next;
+	size_t i;
+	int priority;
+	
+	for (i = 0; i < count; i++) {
+		struct tp_worker *w = &pool->workers[i];
+		
+		while ((work = tp_deque_pop(&w->deque)) != NULL)
+			free(work);
+		
+		for (priority = 0; priority < PRIORITY_MAX; priority++) {
+			for (work = w->inbox_head[priority]; work; work = next) {
+				next = work->next;
+				free(work);
+			}
+		}
+		
+		pthread_mutex_destroy(&w->inbox_mutex);
+	}
+	
+	free(pool->workers);
+	pool->workers = NULL;
+}
+
+static int ws_init_workers(struct thread_pool *pool)
+{
+	size_t i;
+	
+	pool->workers = calloc(pool->num_threads, sizeof(*pool->workers));
+	if (!pool->workers)
+		return -1;
+	
+	for (i = 0; i < pool->num_threads; i++) {
+		struct tp_worker *w = &pool->workers[i];
+		
+		w->pool = pool;
+		w->index = i;
+		if (pthread_mutex_init(&w->inbox_mutex, NULL) != 0) {
+			ws_destroy_workers(pool, i);
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+static int tp_start_worker(struct thread_pool *pool, size_t index)
+{
+	char name[32];
+	int ret;
+	
+	if (pool->workers)
+		ret = pthread_create(&pool->threads[index], NULL, ws_worker_thread,
+		                     &pool->workers[index]);
+	else
+		ret = pthread_create(&pool->threads[index], NULL, worker_thread,
+		                     &pool->slots[index]);
+	if (ret != 0)
+		return -1;
+	
+	if (pool->slots)
+		pool->slots[index].state = TP_SLOT_RUNNING;
+	
+	/* Pinning is best effort, an unpinned worker still works */
+	snprintf(name, sizeof(name), "%s-%zu", pool->name, index);
+	thread_affinity_apply(pool->threads[index], pool->cpus, (int)index, name);
+	return 0;
+}
+
+/* Start a worker in the lowest free slot, called under queue_mutex */
+static bool tp_add_worker(struct thread_pool *pool, bool join)
+{
+	size_t i;
+	
+	for (i = 0; i < pool->capacity; i++) {
+		if (pool->slots[i].state == TP_SLOT_EMPTY ||
+		    (join && pool->slots[i].state == TP_SLOT_EXITED))
+			break;
+	}
+	if (i == pool->capacity)
+		return false;
+	
+	/* Joining a retired worker first */
+	if (pool->slots[i].state == TP_SLOT_EXITED) {
+		pthread_join(pool->threads[i], NULL);
+		pool->slots[i].state = TP_SLOT_EMPTY;
+	}
+	
+	if (tp_start_worker(pool, i) < 0)
+		return false;
+	
+	pool->num_threads++;
+	pool->grown++;
+	return true;
+}
+
+/* Oldest queued item has waited past the target, called under queue_mutex */
+static void tp_maybe_grow(struct thread_pool *pool, uint64_t now)
+{
+	uint64_t oldest = now;
+	int priority;
+	
+	if (pool->num_threads >= pool->capacity || pool->idle_workers >= pool->queue_size ||
+	    now - pool->last_resize_ns < pool->target_wait_ns || tp_stopping(pool))
+		return;
+	
+	for (priority = 0; priority < PRIORITY_MAX; priority++) {
+		if (pool->queue_head[priority] && pool->queue_head[priority]->enqueued_ns < oldest)
+			oldest = pool->queue_head[priority]->enqueued_ns;
+	}
+	if (now - oldest < pool->target_wait_ns)
+		return;
+	
+	/* Retried on a later submission */
+	if (tp_add_worker(pool, true))
+		pool->last_resize_ns = now;
+}
+
+/* Start a worker beside a stalled one, called by the watchdog */
+static bool tp_replace_worker(void *ctx)
+{
+	struct thread_pool *pool = ctx;
+	bool started = false;
+	
+	pthread_mutex_lock(&pool->queue_mutex);
+	if (pool->num_threads < pool->capacity && !tp_stopping(pool)) {
+		/* Retired workers unregister from the watchdog, they cannot be joined here */
+		started = tp_add_worker(pool, false);
+		if (started)
+			pool->last_resize_ns = tp_now_ns();
+	}
+	pthread_mutex_unlock(&pool->queue_mutex);
+	
+	return started;
+}
+
 struct thread_pool *thread_pool_create(size_t num_threads, size_t queue_size)
+{
+	struct thread_pool_options opts = {
+		.num_threads = num_threads,
+		.queue_size = queue_size,
+		.mode = THREAD_POOL_SHARED_QUEUE,
+	};
+	
+	return thread_pool_create_opts(&opts);
+}
+
+/* Release what thread_pool_create_opts() set up before any worker ran */
+static void tp_free(struct thread_pool *pool)
+{
+	free(pool->threads);
+	free(pool->slots);
+	free(pool->cpus);
+	pthread_cond_destroy(&pool->work_done);
+	pthread_cond_destroy(&pool->work_available);
+	pthread_mutex_destroy(&pool->queue_mutex);
+	free(pool);
+}
+
+struct thread_pool *thread_pool_create_opts(const struct thread_pool_options *opts)
 {
 	struct thread_pool *pool;
+	size_t num_threads;
+	struct thread_mempolicy policy = { .valid = false };
+	pthread_condattr_t attr;
 	size_t i;
+	int node;
+	
+	if (!opts)
+		return NULL;
 	
 	pool = calloc(1, sizeof(*pool));
 	if (!pool)
 		return NULL;
 	
 	/* Determine thread count */
+	num_threads = opts->num_threads;
 	if (num_threads == 0)
 		num_threads = get_cpu_count();
 	
+	pool->max_queue_size = opts->queue_size;
+	pool->mode = opts->mode;
+	pool->capacity = num_threads;
+	
+	/* Elastic pools start within [min, max], work-stealing pools stay fixed */
+	if (opts->max_threads > 0 && pool->mode == THREAD_POOL_SHARED_QUEUE) {
+		pool->elastic = true;
+		pool->min_threads = opts->min_threads ? opts->min_threads : 1;
+		pool->capacity = opts->max_threads;
+		if (pool->capacity < pool->min_threads)
+			pool->capacity = pool->min_threads;
+		if (num_threads < pool->min_threads)
+			num_threads = pool->min_threads;
+		if (num_threads > pool->capacity)
+			num_threads = pool->capacity;
+		pool->target_wait_ns = (uint64_t)(opts->target_wait_us ? opts->target_wait_us :
+		                                  THREAD_POOL_DEFAULT_WAIT_US) * 1000;
+		pool->idle_ns = (uint64_t)(opts->idle_ms ? opts->idle_ms :
+		                           THREAD_POOL_DEFAULT_IDLE_MS) * 1000000;
+		pool->last_resize_ns = tp_now_ns();
+	}
 	pool->num_threads = num_threads;
-	pool->max_queue_size = queue_size;
+	snprintf(pool->name, sizeof(pool->name), "%s", opts->name ? opts->name : "tp-worker");
 	
-	/* Initialize synchronization primitives */
+	/* Initialize synchronization primitives, timed waits use CLOCK_MONOTONIC */
 	if (pthread_mutex_init(&pool->queue_mutex, NULL) != 0) {
 		free(pool);
 		return NULL;
 	}
 	
-	if (pthread_cond_init(&pool->work_available, NULL) != 0) {
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	if (pthread_cond_init(&pool->work_available, &attr) != 0) {
+		pthread_condattr_destroy(&attr);
 		pthread_mutex_destroy(&pool->queue_mutex);
 		free(pool);
 		return NULL;
 	}
+	pthread_condattr_destroy(&attr);
 	
 	if (pthread_cond_init(&pool->work_done, NULL) != 0) {
 		pthread_cond_destroy(&pool->work_available);
@@ -159,31 +786,55 @@ struct thread_pool *thread_pool_create(size_t num_threads, size_t queue_size)
 	atomic_init(&pool->submitted_count, 0);
 	atomic_init(&pool->completed_count, 0);
 	atomic_init(&pool->rejected_count, 0);
+	atomic_init(&pool->pending, 0);
+	atomic_init(&pool->parked, 0);
+	atomic_init(&pool->waiters, 0);
+	atomic_init(&pool->next_worker, 0);
 	
-	/* Create worker threads */
-	pool->threads = calloc(num_threads, sizeof(pthread_t));
-	if (!pool->threads) {
-		pthread_cond_destroy(&pool->work_done);
-		pthread_cond_destroy(&pool->work_available);
-		pthread_mutex_destroy(&pool->queue_mutex);
-		free(pool);
+	/* Workers started later are pinned and named like the first ones */
+	pool->threads = calloc(pool->capacity, sizeof(pthread_t));
+	if (pool->mode == THREAD_POOL_SHARED_QUEUE)
+		pool->slots = calloc(pool->capacity, sizeof(*pool->slots));
+	if (opts->cpus)
+		pool->cpus = strdup(opts->cpus);
+	if (!pool->threads || (pool->mode == THREAD_POOL_SHARED_QUEUE && !pool->slots) ||
+	    (opts->cpus && !pool->cpus)) {
+		tp_free(pool);
 		return NULL;
 	}
 	
+	for (i = 0; pool->slots && i < pool->capacity; i++) {
+		pool->slots[i].pool = pool;
+		pool->slots[i].index = i;
+	}
+	
+	/* Worker deques live on the workers' NUMA node */
+	node = thread_affinity_node(opts->cpus);
+	if (node >= 0)
+		thread_affinity_prefer_node(node, &policy);
+	
+	if (pool->mode == THREAD_POOL_WORK_STEALING && ws_init_workers(pool) < 0) {
+		thread_affinity_restore(&policy);
+		tp_free(pool);
+		return NULL;
+	}
+	
+	thread_affinity_restore(&policy);
+	
 	for (i = 0; i < num_threads; i++) {
-		if (pthread_create(&pool->threads[i], NULL, worker_thread, pool) != 0) {
+		if (tp_start_worker(pool, i) < 0) {
 			/* Cleanup on failure */
 			atomic_store_explicit(&pool->immediate_shutdown, true, memory_order_release);
+			pthread_mutex_lock(&pool->queue_mutex);
 			pthread_cond_broadcast(&pool->work_available);
+			pthread_mutex_unlock(&pool->queue_mutex);
 			
 			for (size_t j = 0; j < i; j++)
 				pthread_join(pool->threads[j], NULL);
 			
-			free(pool->threads);
-			pthread_cond_destroy(&pool->work_done);
-			pthread_cond_destroy(&pool->work_available);
-			pthread_mutex_destroy(&pool->queue_mutex);
-			free(pool);
+			if (pool->workers)
+				ws_destroy_workers(pool, num_threads);
+			tp_free(pool);
 			return NULL;
 		}
 	}
@@ -210,11 +861,16 @@ void thread_pool_destroy(struct thread_pool *pool, bool wait)
 	pthread_cond_broadcast(&pool->work_available);
 	pthread_mutex_unlock(&pool->queue_mutex);
 	
-	/* Wait for threads to finish */
-	for (i = 0; i < pool->num_threads; i++)
-		pthread_join(pool->threads[i], NULL);
+	/* Wait for threads to finish, retired elastic workers included */
+	for (i = 0; i < pool->capacity; i++) {
+		if (!pool->slots || pool->slots[i].state != TP_SLOT_EMPTY)
+			pthread_join(pool->threads[i], NULL);
+	}
 	
 	/* Free remaining work items */
+	if (pool->workers)
+		ws_destroy_workers(pool, pool->num_threads);
+	
 	for (i = 0; i < PRIORITY_MAX; i++) {
 		work = pool->queue_head[i];
 		while (work) {
@@ -224,12 +880,7 @@ void thread_pool_destroy(struct thread_pool *pool, bool wait)
 		}
 	}
 	
-	/* Cleanup */
-	free(pool->threads);
-	pthread_cond_destroy(&pool->work_done);
-	pthread_cond_destroy(&pool->work_available);
-	pthread_mutex_destroy(&pool->queue_mutex);
-	free(pool);
+	tp_free(pool);
 }
 
 bool thread_pool_submit(struct thread_pool *pool, work_func_t func,
@@ -247,14 +898,16 @@ bool thread_pool_submit(struct thread_pool *pool, work_func_t func,
 	if (atomic_load_explicit(&pool->shutdown, memory_order_acquire))
 		return false;
 	
-	/* Check queue size limit */
-	pthread_mutex_lock(&pool->queue_mutex);
-	if (pool->max_queue_size > 0 && pool->queue_size >= pool->max_queue_size) {
+	/* Check queue size limit, ws_submit() reserves its own slot */
+	if (!pool->workers) {
+		pthread_mutex_lock(&pool->queue_mutex);
+		if (pool->max_queue_size > 0 && pool->queue_size >= pool->max_queue_size) {
+			pthread_mutex_unlock(&pool->queue_mutex);
+			atomic_fetch_add_explicit(&pool->rejected_count, 1, memory_order_relaxed);
+			return false;
+		}
 		pthread_mutex_unlock(&pool->queue_mutex);
-		atomic_fetch_add_explicit(&pool->rejected_count, 1, memory_order_relaxed);
-		return false;
 	}
-	pthread_mutex_unlock(&pool->queue_mutex);
 	
 	/* Create work item */
 	work = malloc(sizeof(*work));
@@ -266,8 +919,18 @@ bool thread_pool_submit(struct thread_pool *pool, work_func_t func,
 	work->func = func;
 	work->arg = arg;
 	work->priority = priority;
+	work->enqueued_ns = pool->elastic ? tp_now_ns() : 0;
 	work->next = NULL;
 	
+	if (pool->workers) {
+		if (!ws_submit(pool, work)) {
+			free(work);
+			atomic_fetch_add_explicit(&pool->rejected_count, 1, memory_order_relaxed);
+			return false;
+		}
+		return true;
+	}
+	
 	/* Add to queue */
 	pthread_mutex_lock(&pool->queue_mutex);
 	
@@ -281,6 +944,9 @@ bool thread_pool_submit(struct thread_pool *pool, work_func_t func,
 	
 	atomic_fetch_add_explicit(&pool->submitted_count, 1, memory_order_relaxed);
 	
+	if (pool->elastic)
+		tp_maybe_grow(pool, work->enqueued_ns);
+	
 	/* Signal worker threads */
 	pthread_cond_signal(&pool->work_available);
 	pthread_mutex_unlock(&pool->queue_mutex);
@@ -293,6 +959,17 @@ void thread_pool_wait(struct thread_pool *pool)
 	if (!pool)
 		return;
 	
+	if (pool->workers) {
+		/* Pairs with the waiters check after each work item */
+		atomic_fetch_add(&pool->waiters, 1);
+		pthread_mutex_lock(&pool->queue_mutex);
+		while (atomic_load(&pool->pending) > 0 || atomic_load(&pool->active_threads) > 0)
+			pthread_cond_wait(&pool->work_done, &pool->queue_mutex);
+		pthread_mutex_unlock(&pool->queue_mutex);
+		atomic_fetch_sub(&pool->waiters, 1);
+		return;
+	}
+	
 	pthread_mutex_lock(&pool->queue_mutex);
 	while (pool->queue_size > 0 || 
 	       atomic_load_explicit(&pool->active_threads, memory_order_relaxed) > 0) {
@@ -303,9 +980,18 @@ void thread_pool_wait(struct thread_pool *pool)
 
 size_t thread_pool_get_thread_count(struct thread_pool *pool)
 {
+	size_t count;
+	
 	if (!pool)
 		return 0;
-	return pool->num_threads;
+	if (!pool->elastic)
+		return pool->num_threads;
+	
+	pthread_mutex_lock(&pool->queue_mutex);
+	count = pool->num_threads;
+	pthread_mutex_unlock(&pool->queue_mutex);
+	
+	return count;
 }
 
 size_t thread_pool_get_pending_count(struct thread_pool *pool)
@@ -315,6 +1001,9 @@ size_t thread_pool_get_pending_count(struct thread_pool *pool)
 	if (!pool)
 		return 0;
 	
+	if (pool->workers)
+		return atomic_load_explicit(&pool->pending, memory_order_relaxed);
+	
 	pthread_mutex_lock(&pool->queue_mutex);
 	count = pool->queue_size;
 	pthread_mutex_unlock(&pool->queue_mutex);
@@ -337,3 +1026,42 @@ void thread_pool_stats(struct thread_pool *pool,
 	if (rejected)
 		*rejected = atomic_load_explicit(&pool->rejected_count, memory_order_relaxed);
 }
+
+void thread_pool_sched_stats(struct thread_pool *pool,
+                             unsigned long *steals,
+                             unsigned long *parks)
+{
+	unsigned long total_steals = 0, total_parks = 0;
+	size_t i;
+	
+	if (!pool)
+		return;
+	
+	for (i = 0; pool->workers && i < pool->num_threads; i++) {
+		total_steals += atomic_load_explicit(&pool->workers[i].steals, memory_order_relaxed);
+		total_parks += atomic_load_explicit(&pool->workers[i].parks, memory_order_relaxed);
+	}
+	
+	if (steals)
+		*steals = total_steals;
+	if (parks)
+		*parks = total_parks;
+}
+
+void thread_pool_elastic_stats(struct thread_pool *pool,
+                               unsigned long *grown,
+                               unsigned long *shrunk,
+                               unsigned long *wait_us)
+{
+	if (!pool)
+		return;
+	
+	pthread_mutex_lock(&pool->queue_mutex);
+	if (grown)
+		*grown = pool->grown;
+	if (shrunk)
+		*shrunk = pool->shrunk;
+	if (wait_us)
+		*wait_us = (unsigned long)(pool->wait_ewma_ns / 1000);
+	pthread_mutex_unlock(&pool->queue_mutex);
+}
@@ -0,0 +1,475 @@
+/* webhook_sender.c - Asynchronous webhook delivery
+ *
+ * Submitters append payloads to the queue of their endpoint under the
+ * sender lock and wake the delivery thread, which owns the curl multi
+ * handle and every easy handle. Per loop pass it moves the payloads of
+ * each idle endpoint into one batch, adds the endpoint's easy handle for
+ * it and polls until a request completes, new payloads arrive or a retry
+ * is due. A batch stays with its endpoint across retries, so payloads of
+ * one endpoint are delivered in order and a dead endpoint only holds up
+ * its own queue.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <curl/curl.h>
+#include "webhook_sender.h"
+
+/* Longest retry delay */
+#define WEBHOOK_MAX_RETRY_MS 60000
+
+/* Queued payload */
+struct webhook_item {
+	char *payload;
+	size_t len;
+	uint32_t timeout_ms;
+	struct webhook_item *next;
+};
+
+/* Endpoint state, the easy handle and request fields belong to the thread */
+struct webhook_endpoint {
+	char url[WEBHOOK_MAX_URL];
+	CURL *curl;                      /* Kept across requests for connection reuse */
+	
+	/* Payloads waiting for a batch */
+	struct webhook_item *head;
+	struct webhook_item *tail;
+	
+	/* Batch being sent or waiting for its retry */
+	struct webhook_item *batch;
+	size_t batch_count;
+	char *body;                      /* JSON array of a batch of several */
+	uint32_t attempts;               /* Retries made */
+	uint64_t retry_at_us;
+	uint64_t started_us;
+	bool in_flight;
+	
+	size_t queued;
+	uint64_t latency_total_us;
+	struct webhook_endpoint_stats stats;
+};
+
+/* Webhook sender structure */
+struct webhook_sender {
+	struct webhook_sender_config config;
+	CURLM *multi;
+	struct curl_slist *headers;
+	pthread_t thread;
+	
+	pthread_mutex_t lock;            /* Guards the queues, batches and statistics */
+	struct webhook_endpoint endpoints[WEBHOOK_MAX_ENDPOINTS];
+	size_t endpoint_count;           /* Endpoints are never removed */
+	size_t queued;
+	bool stopping;
+};
+
+/* Helper: Get monotonic time in microseconds */
+static uint64_t get_time_us(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* Helper: Webhook response callback */
+static size_t response_discard(void *contents, size_t size, size_t nmemb, void *userp)
+{
+	(void)contents;
+	(void)userp;
+	
+	/* Discard response data */
+	return size * nmemb;
+}
+
+static void item_free_list(struct webhook_item *item)
+{
+	struct webhook_item *next;
+	
+	for (; item; item = next) {
+		next = item->next;
+		free(item->payload);
+		free(item);
+	}
+}
+
+/* Endpoint of url, added if new; lock held */
+static struct webhook_endpoint *endpoint_get(struct webhook_sender *ws, const char *url)
+{
+	struct webhook_endpoint *ep;
+	
+	for (size_t i = 0; i < ws->endpoint_count; i++) {
+		if (strncmp(ws->endpoints[i].url, url, WEBHOOK_MAX_URL - 1) == 0)
+			return &ws->endpoints[i];
+	}
+	
+	if (ws->endpoint_count >= WEBHOOK_MAX_ENDPOINTS)
+		return NULL;
+	
+	ep = &ws->endpoints[ws->endpoint_count++];
+	strncpy(ep->url, url, WEBHOOK_MAX_URL - 1);
+	strncpy(ep->stats.url, url, WEBHOOK_MAX_URL - 1);
+	return ep;
+}
+
+/* Move up to max_batch waiting payloads of ep into its batch; lock held */
+static void batch_take(struct webhook_sender *ws, struct webhook_endpoint *ep)
+{
+	struct webhook_item *item, **link = &ep->batch;
+	size_t len = 2;
+	char *p;
+	
+	ep->batch_count = 0;
+	while (ep->head && ep->batch_count < ws->config.max_batch) {
+		item = ep->head;
+		ep->head = item->next;
+		item->next = NULL;
+		*link = item;
+		link = &item->next;
+		len += item->len + 1;
+		ep->batch_count++;
+	}
+	if (!ep->head)
+		ep->tail = NULL;
+	
+	if (ep->batch_count < 2)
+		return;
+	
+	/* Several payloads go as one array, without it they are sent singly */
+	ep->body = malloc(len);
+	if (!ep->body)
+		return;
+	
+	p = ep->body;
+	*p++ = '[';
+	for (item = ep->batch; item; item = item->next) {
+		memcpy(p, item->payload, item->len);
+		p += item->len;
+		*p++ = item->next ? ',' : ']';
+	}
+	*p = '\0';
+}
+
+/* Account for and drop the batch of ep; lock held */
+static void batch_done(struct webhook_sender *ws, struct webhook_endpoint *ep, bool delivered)
+{
+	if (delivered)
+		ep->stats.delivered += ep->batch_count;
+	else
+		ep->stats.failed += ep->batch_count;
+	
+	ws->queued -= ep->batch_count;
+	ep->queued -= ep->batch_count;
+	item_free_list(ep->batch);
+	free(ep->body);
+	ep->batch = NULL;
+	ep->batch_count = 0;
+	ep->body = NULL;
+	ep->attempts = 0;
+	ep->retry_at_us = 0;
+}
+
+/* Start the POST of the batch of ep; lock held */
+static bool request_start(struct webhook_sender *ws, struct webhook_endpoint *ep, uint64_t now)
+{
+	const char *body = ep->body;
+	size_t len;
+	uint32_t timeout_ms = ep->batch->timeout_ms;
+	
+	/* A batch whose array could not be built is sent as its first payload */
+	if (!body) {
+		body = ep->batch->payload;
+		len = ep->batch->len;
+		if (ep->batch_count > 1) {
+			item_free_list(ep->batch->next);
+			ep->batch->next = NULL;
+			ws->queued -= ep->batch_count - 1;
+			ep->queued -= ep->batch_count - 1;
+			ep->stats.failed += ep->batch_count - 1;
+			ep->batch_count = 1;
+		}
+	} else {
+		len = strlen(body);
+	}
+	
+	if (!ep->curl) {
+		ep->curl = curl_easy_init();
+		if (!ep->curl)
+			return false;
+		
+		curl_easy_setopt(ep->curl, CURLOPT_URL, ep->url);
+		curl_easy_setopt(ep->curl, CURLOPT_HTTPHEADER, ws->headers);
+		curl_easy_setopt(ep->curl, CURLOPT_WRITEFUNCTION, response_discard);
+		curl_easy_setopt(ep->curl, CURLOPT_PRIVATE, ep);
+		curl_easy_setopt(ep->curl, CURLOPT_NOSIGNAL, 1L);
+		curl_easy_setopt(ep->curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	}
+	
+	curl_easy_setopt(ep->curl, CURLOPT_POSTFIELDSIZE, (long)len);
+	curl_easy_setopt(ep->curl, CURLOPT_POSTFIELDS, body);
+	curl_easy_setopt(ep->curl, CURLOPT_TIMEOUT_MS,
+	                 (long)(timeout_ms ? timeout_ms : WEBHOOK_DEFAULT_TIMEOUT_MS));
+	
+	if (curl_multi_add_handle(ws->multi, ep->curl) != CURLM_OK)
+		return false;
+	
+	ep->in_flight = true;
+	ep->started_us = now;
+	return true;
+}
+
+/* Account for the completed request of easy, retrying it if it may succeed */
+static void request_done(struct webhook_sender *ws, CURL *easy, CURLcode result)
+{
+	struct webhook_endpoint *ep = NULL;
+	long code = 0;
+	uint64_t now = get_time_us(), elapsed;
+	bool delivered, retry;
+	
+	curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char **)&ep);
+	curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &code);
+	curl_multi_remove_handle(ws->multi, easy);
+	
+	delivered = result == CURLE_OK && code >= 200 && code < 300;
+	retry = !delivered && (result != CURLE_OK || code == 429 || code >= 500);
+	
+	pthread_mutex_lock(&ws->lock);
+	
+	ep->in_flight = false;
+	elapsed = now - ep->started_us;
+	ep->stats.requests++;
+	ep->latency_total_us += elapsed;
+	if (elapsed > ep->stats.latency_max_us)
+		ep->stats.latency_max_us = elapsed;
+	
+	if (retry && !ws->stopping && ep->attempts < ws->config.max_retries) {
+		uint32_t shift = ep->attempts < 16 ? ep->attempts : 16;
+		uint64_t delay_ms = (uint64_t)ws->config.retry_base_ms << shift;
+		
+		if (delay_ms > WEBHOOK_MAX_RETRY_MS)
+			delay_ms = WEBHOOK_MAX_RETRY_MS;
+		ep->attempts++;
+		ep->stats.retries++;
+		ep->retry_at_us = now + delay_ms * 1000;
+	} else {
+		batch_done(ws, ep, delivered);
+	}
+	
+	pthread_mutex_unlock(&ws->lock);
+}
+
+/* Delivery thread */
+static void *sender_thread(void *arg)
+{
+	struct webhook_sender *ws = arg;
+	
+	for (;;) {
+		uint64_t now = get_time_us();
+		int timeout_ms = 1000;
+		bool idle = true, completed = false;
+		int running, left;
+		CURLMsg *msg;
+		
+		pthread_mutex_lock(&ws->lock);
+		
+		for (size_t i = 0; i < ws->endpoint_count; i++) {
+			struct webhook_endpoint *ep = &ws->endpoints[i];
+			
+			if (ep->in_flight) {
+				idle = false;
+				continue;
+			}
+			
+			if (!ep->batch && ep->head)
+				batch_take(ws, ep);
+			if (!ep->batch)
+				continue;
+			
+			idle = false;
+			if (now < ep->retry_at_us && !ws->stopping) {
+				uint64_t wait_ms = (ep->retry_at_us - now) / 1000 + 1;
+				
+				if (wait_ms < (uint64_t)timeout_ms)
+					timeout_ms = (int)wait_ms;
+				continue;
+			}
+			
+			if (!request_start(ws, ep, now))
+				batch_done(ws, ep, false);
+		}
+		
+		if (ws->stopping && idle) {
+			pthread_mutex_unlock(&ws->lock);
+			break;
+		}
+		
+		pthread_mutex_unlock(&ws->lock);
+		
+		curl_multi_perform(ws->multi, &running);
+		while ((msg = curl_multi_info_read(ws->multi, &left))) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+			request_done(ws, msg->easy_handle, msg->data.result);
+			completed = true;
+		}
+		
+		/* Completed endpoints may have payloads waiting */
+		if (!completed)
+			curl_multi_poll(ws->multi, NULL, 0, timeout_ms, NULL);
+	}
+	
+	return NULL;
+}
+
+struct webhook_sender *webhook_sender_create(const struct webhook_sender_config *config)
+{
+	struct webhook_sender *ws;
+	
+	ws = calloc(1, sizeof(*ws));
+	if (!ws)
+		return NULL;
+	
+	if (config)
+		ws->config = *config;
+	if (ws->config.queue_size == 0)
+		ws->config.queue_size = WEBHOOK_DEFAULT_QUEUE_SIZE;
+	if (ws->config.max_batch == 0)
+		ws->config.max_batch = WEBHOOK_DEFAULT_MAX_BATCH;
+	if (ws->config.max_retries == 0)
+		ws->config.max_retries = WEBHOOK_DEFAULT_MAX_RETRIES;
+	if (ws->config.retry_base_ms == 0)
+		ws->config.retry_base_ms = WEBHOOK_DEFAULT_RETRY_MS;
+	
+	ws->multi = curl_multi_init();
+	if (!ws->multi) {
+		free(ws);
+		return NULL;
+	}
+	
+	ws->headers = curl_slist_append(NULL, "Content-Type: application/json");
+	if (!ws->headers) {
+		curl_multi_cleanup(ws->multi);
+		free(ws);
+		return NULL;
+	}
+	
+	if (pthread_mutex_init(&ws->lock, NULL) != 0) {
+		curl_slist_free_all(ws->headers);
+		curl_multi_cleanup(ws->multi);
+		free(ws);
+		return NULL;
+	}
+	
+	if (pthread_create(&ws->thread, NULL, sender_thread, ws) != 0) {
+		pthread_mutex_destroy(&ws->lock);
+		curl_slist_free_all(ws->headers);
+		curl_multi_cleanup(ws->multi);
+		free(ws);
+		return NULL;
+	}
+	
+	return ws;
+}
+
+void webhook_sender_destroy(struct webhook_sender *ws)
+{
+	if (!ws)
+		return;
+	
+	pthread_mutex_lock(&ws->lock);
+	ws->stopping = true;
+	pthread_mutex_unlock(&ws->lock);
+	
+	curl_multi_wakeup(ws->multi);
+	pthread_join(ws->thread, NULL);
+	
+	for (size_t i = 0; i < ws->endpoint_count; i++) {
+		struct webhook_endpoint *ep = &ws->endpoints[i];
+		
+		item_free_list(ep->head);
+		item_free_list(ep->batch);
+		free(ep->body);
+		if (ep->curl)
+			curl_easy_cleanup(ep->curl);
+	}
+	
+	curl_multi_cleanup(ws->multi);
+	curl_slist_free_all(ws->headers);
+	pthread_mutex_destroy(&ws->lock);
+	free(ws);
+}
+
+bool webhook_sender_submit(struct webhook_sender *ws, const char *url,
+                           const char *payload, uint32_t timeout_ms)
+{
+	struct webhook_endpoint *ep;
+	struct webhook_item *item;
+	
+	if (!ws || !url || !payload || url[0] == '\0')
+		return false;
+	
+	/* Copy outside the lock */
+	item = calloc(1, sizeof(*item));
+	if (!item)
+		return false;
+	
+	item->len = strlen(payload);
+	item->payload = strdup(payload);
+	item->timeout_ms = timeout_ms;
+	if (!item->payload) {
+		free(item);
+		return false;
+	}
+	
+	pthread_mutex_lock(&ws->lock);
+	
+	ep = endpoint_get(ws, url);
+	if (!ep || ws->queued >= ws->config.queue_size || ws->stopping) {
+		if (ep)
+			ep->stats.dropped++;
+		pthread_mutex_unlock(&ws->lock);
+		item_free_list(item);
+		return false;
+	}
+	
+	if (ep->tail)
+		ep->tail->next = item;
+	else
+		ep->head = item;
+	ep->tail = item;
+	ep->queued++;
+	ws->queued++;
+	
+	pthread_mutex_unlock(&ws->lock);
+	
+	curl_multi_wakeup(ws->multi);
+	return true;
+}
+
+size_t webhook_sender_get_stats(struct webhook_sender *ws,
+                                struct webhook_endpoint_stats *stats,
+                                size_t max_stats)
+{
+	size_t count;
+	
+	if (!ws || !stats)
+		return 0;
+	
+	pthread_mutex_lock(&ws->lock);
+	
+	count = ws->endpoint_count < max_stats ? ws->endpoint_count : max_stats;
+	for (size_t i = 0; i < count; i++) {
+		struct webhook_endpoint *ep = &ws->endpoints[i];
+		
+		stats[i] = ep->stats;
+		stats[i].queued = ep->queued;
+		stats[i].latency_avg_us = ep->stats.requests ?
+		                          ep->latency_total_us / ep->stats.requests : 0;
+	}
+	
+	pthread_mutex_unlock(&ws->lock);
+	
+	return count;
+}
@@ -0,0 +1,115 @@
+/* window_counter.c - Event counts over a sliding time window
+ *
+ * Bucket i of the ring counts the events of one bucket width of time.
+ * The newest bucket is at head; moving the window on by k buckets clears
+ * the k oldest ones and subtracts them from the total, so each bucket is
+ * cleared at most once per pass around the ring.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "window_counter.h"
+
+struct window_counter {
+	uint64_t *buckets;
+	size_t bucket_count;
+	time_t width;                   /* Seconds per bucket */
+	size_t head;                    /* Bucket of the newest slot */
+	int64_t head_slot;              /* Timestamp / width of the newest bucket */
+	uint64_t total;
+};
+
+struct window_counter *window_counter_create(time_t window_sec)
+{
+	struct window_counter *wc;
+	time_t seconds;
+	
+	if (window_sec <= 0)
+		return NULL;
+	
+	wc = calloc(1, sizeof(*wc));
+	if (!wc)
+		return NULL;
+	
+	/* The window includes both the oldest and the newest second */
+	seconds = window_sec + 1;
+	wc->width = (seconds + WINDOW_COUNTER_MAX_BUCKETS - 1) / WINDOW_COUNTER_MAX_BUCKETS;
+	wc->bucket_count = (size_t)((seconds + wc->width - 1) / wc->width);
+	
+	wc->buckets = calloc(wc->bucket_count, sizeof(*wc->buckets));
+	if (!wc->buckets) {
+		free(wc);
+		return NULL;
+	}
+	
+	return wc;
+}
+
+void window_counter_destroy(struct window_counter *wc)
+{
+	if (!wc)
+		return;
+	
+	free(wc->buckets);
+	free(wc);
+}
+
+/* Move the newest bucket on to slot, clearing the buckets it passes */
+static void window_advance(struct window_counter *wc, int64_t slot)
+{
+	int64_t steps = slot - wc->head_slot;
+	
+	if (steps <= 0)
+		return;
+	
+	if (steps >= (int64_t)wc->bucket_count) {
+		if (wc->total)
+			window_counter_reset(wc);
+	} else {
+		while (steps-- > 0 && wc->total) {
+			wc->head = (wc->head + 1) % wc->bucket_count;
+			wc->total -= wc->buckets[wc->head];
+			wc->buckets[wc->head] = 0;
+		}
+	}
+	
+	wc->head_slot = slot;
+}
+
+void window_counter_add(struct window_counter *wc, time_t timestamp, uint32_t n)
+{
+	int64_t slot, age;
+	
+	if (!wc || n == 0)
+		return;
+	
+	slot = timestamp / wc->width;
+	if (!wc->total)
+		wc->head_slot = slot;
+	window_advance(wc, slot);
+	
+	age = wc->head_slot - slot;
+	if (age >= (int64_t)wc->bucket_count)
+		return;
+	
+	wc->buckets[(wc->head + wc->bucket_count - (size_t)age) % wc->bucket_count] += n;
+	wc->total += n;
+}
+
+uint64_t window_counter_count(struct window_counter *wc, time_t now)
+{
+	if (!wc)
+		return 0;
+	
+	window_advance(wc, now / wc->width);
+	return wc->total;
+}
+
+void window_counter_reset(struct window_counter *wc)
+{
+	if (!wc)
+		return;
+	
+	memset(wc->buckets, 0, wc->bucket_count * sizeof(*wc->buckets));
+	wc->total = 0;
+}
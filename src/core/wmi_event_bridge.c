@@ -3,6 +3,16 @@
  * @brief WMI to nlmon event bridge implementation
  *
  * Converts WMI log entries into nlmon events for unified processing.
+ *
+ * The event processor copies each event and its metadata on submit, so
+ * conversion fills arrays owned by the bridge and reused for every batch
+ * instead of allocating per entry. The display string is formatted from
+ * the metadata by the handler, only when it is printed.
+ *
+ * Every log source added with wmi_bridge_add_source() has a reader and
+ * thread of its own. Its entries are numbered in the order read, so
+ * consumers of the merged event stream can restore each source's order
+ * and spot gaps.
  */
 
 #include <stdio.h>
@@ -15,10 +25,28 @@
 #include "../../include/qca_wmi.h"
 #include "../../include/event_processor.h"
 #include "../../include/wmi_log_reader.h"
+#include "../../include/pipeline_watchdog.h"
 
 /* Event type for WMI events */
 #define NLMON_EVENT_WMI 0x1000
 
+/* Log source feeding the bridge */
+struct bridge_source {
+    uint32_t id;
+    struct wmi_log_reader *reader;
+    pthread_t thread;
+    bool thread_started;
+    atomic_bool running;
+    uint64_t next_seq;           /* Sequence of the next entry, reading thread only */
+    atomic_ullong entries;
+    atomic_ullong submitted;
+    char *log_source;
+    
+    /* Entries parsed by the log reader callback, not yet submitted */
+    struct wmi_log_entry pending[WMI_BRIDGE_BATCH_SIZE];
+    size_t pending_count;
+};
+
 /* Bridge state */
 static struct {
     struct event_processor *event_processor;
@@ -32,6 +60,13 @@ static struct {
     atomic_ullong events_converted;
     atomic_ullong events_submitted;
     atomic_ullong conversion_errors;
+    
+    /* Conversion buffers reused by every batch, under mutex */
+    struct nlmon_event batch_events[WMI_BRIDGE_BATCH_SIZE];
+    struct wmi_event_metadata batch_metadata[WMI_BRIDGE_BATCH_SIZE];
+    
+    /* Source 0 is wmi_bridge_start_monitoring()'s, added ones follow */
+    _Atomic(struct bridge_source *) sources[WMI_BRIDGE_MAX_SOURCES + 1];
 } bridge_state = {
     .mutex = PTHREAD_MUTEX_INITIALIZER,
 };
@@ -68,27 +103,14 @@ int wmi_bridge_init(struct wmi_bridge_config *config)
 }
 
 /**
- * Convert WMI log entry to nlmon event
+ * Fill metadata and an event pointing at it from a WMI log entry
  */
-int wmi_to_nlmon_event(const struct wmi_log_entry *wmi_entry,
-                       struct nlmon_event *event)
+static void convert_entry(const struct wmi_log_entry *wmi_entry,
+                          struct wmi_event_metadata *metadata,
+                          struct nlmon_event *event)
 {
-    struct wmi_event_metadata *metadata;
-    char display_buf[512];
-    char *display_str;
-    
-    if (!wmi_entry || !event) {
-        return -1;
-    }
-    
-    /* Allocate metadata structure */
-    metadata = calloc(1, sizeof(*metadata));
-    if (!metadata) {
-        atomic_fetch_add(&bridge_state.conversion_errors, 1);
-        return -2;
-    }
-    
     /* Populate metadata from WMI entry */
+    memset(metadata, 0, sizeof(*metadata));
     metadata->cmd_id = wmi_entry->cmd_id;
     strncpy(metadata->command_name, wmi_entry->command_name,
             sizeof(metadata->command_name) - 1);
@@ -107,6 +129,37 @@ int wmi_to_nlmon_event(const struct wmi_log_entry *wmi_entry,
     metadata->has_stats = wmi_entry->has_stats;
     metadata->has_peer = wmi_entry->has_peer;
     
+    /* Populate nlmon event structure */
+    memset(event, 0, sizeof(*event));
+    event->timestamp = wmi_entry->timestamp;
+    event->event_type = NLMON_EVENT_WMI;
+    event->message_type = wmi_entry->cmd_id & 0xFFFF;
+    strncpy(event->interface, "wmi0", sizeof(event->interface) - 1);
+    event->data = metadata;
+    event->data_size = sizeof(*metadata);
+}
+
+/**
+ * Convert WMI log entry to nlmon event
+ */
+int wmi_to_nlmon_event(const struct wmi_log_entry *wmi_entry,
+                       struct nlmon_event *event)
+{
+    struct wmi_event_metadata *metadata;
+    char display_buf[512];
+    char *display_str;
+    
+    if (!wmi_entry || !event) {
+        return -1;
+    }
+    
+    /* Allocate metadata structure */
+    metadata = calloc(1, sizeof(*metadata));
+    if (!metadata) {
+        atomic_fetch_add(&bridge_state.conversion_errors, 1);
+        return -2;
+    }
+    
     /* Format display string with all relevant information */
     wmi_format_entry(wmi_entry, display_buf, sizeof(display_buf));
     
@@ -117,14 +170,7 @@ int wmi_to_nlmon_event(const struct wmi_log_entry *wmi_entry,
         return -2;
     }
     
-    /* Populate nlmon event structure */
-    memset(event, 0, sizeof(*event));
-    event->timestamp = wmi_entry->timestamp;
-    event->event_type = NLMON_EVENT_WMI;
-    event->message_type = wmi_entry->cmd_id & 0xFFFF;
-    strncpy(event->interface, "wmi0", sizeof(event->interface) - 1);
-    event->data = metadata;
-    event->data_size = sizeof(*metadata);
+    convert_entry(wmi_entry, metadata, event);
     event->user_data = display_str;
     
     atomic_fetch_add(&bridge_state.events_converted, 1);
@@ -132,6 +178,30 @@ int wmi_to_nlmon_event(const struct wmi_log_entry *wmi_entry,
     return 0;
 }
 
+/**
+ * Rebuild the WMI log entry of a bridged event, for formatting
+ */
+static void metadata_to_entry(const struct nlmon_event *event,
+                              const struct wmi_event_metadata *metadata,
+                              struct wmi_log_entry *wmi_entry)
+{
+    memset(wmi_entry, 0, sizeof(*wmi_entry));
+    wmi_entry->timestamp = event->timestamp;
+    wmi_entry->cmd_id = metadata->cmd_id;
+    memcpy(wmi_entry->command_name, metadata->command_name, sizeof(wmi_entry->command_name));
+    wmi_entry->vdev_id = metadata->vdev_id;
+    wmi_entry->pdev_id = metadata->pdev_id;
+    wmi_entry->stats_id = metadata->stats_id;
+    memcpy(wmi_entry->stats_type, metadata->stats_type, sizeof(wmi_entry->stats_type));
+    wmi_entry->req_id = metadata->req_id;
+    memcpy(wmi_entry->peer_mac, metadata->peer_mac, sizeof(wmi_entry->peer_mac));
+    wmi_entry->htc_tag = metadata->htc_tag;
+    memcpy(wmi_entry->thread_name, metadata->thread_name, sizeof(wmi_entry->thread_name));
+    wmi_entry->thread_id = metadata->thread_id;
+    wmi_entry->has_stats = metadata->has_stats;
+    wmi_entry->has_peer = metadata->has_peer;
+}
+
 /**
  * WMI event handler callback
  */
@@ -144,19 +214,30 @@ static void wmi_event_handler(struct nlmon_event *event, void *ctx)
         return;
     }
     
+    (void)ctx;
+    
     metadata = (struct wmi_event_metadata *)event->data;
     display_str = (char *)event->user_data;
     
     if (bridge_state.verbose) {
-        printf("[WMI] %s\n", display_str ? display_str : "");
-    }
-    
-    /* Free allocated resources */
-    if (metadata) {
-        free(metadata);
-        event->data = NULL;
+        if (display_str) {
+            printf("[WMI] %s\n", display_str);
+        } else if (metadata) {
+            struct wmi_log_entry wmi_entry;
+            char display_buf[512];
+            
+            metadata_to_entry(event, metadata, &wmi_entry);
+            wmi_format_entry(&wmi_entry, display_buf, sizeof(display_buf));
+            if (metadata->source_id) {
+                printf("[WMI:%u] %s\n", metadata->source_id, display_buf);
+            } else {
+                printf("[WMI] %s\n", display_buf);
+            }
+        }
     }
     
+    /* The metadata is the processor's copy, freed with the event. A
+     * display string comes from wmi_to_nlmon_event() and is ours. */
     if (display_str) {
         free(display_str);
         event->user_data = NULL;
@@ -211,9 +292,8 @@ int wmi_register_event_handler(void)
  */
 int wmi_bridge_submit(const struct wmi_log_entry *wmi_entry)
 {
+    struct wmi_event_metadata metadata;
     struct nlmon_event event;
-    bool submitted;
-    int ret;
     
     if (!atomic_load(&bridge_state.initialized)) {
         return -1;
@@ -229,22 +309,12 @@ int wmi_bridge_submit(const struct wmi_log_entry *wmi_entry)
         return 0;
     }
     
-    /* Convert WMI entry to nlmon event */
-    ret = wmi_to_nlmon_event(wmi_entry, &event);
-    if (ret < 0) {
-        return -2;
-    }
+    /* Convert WMI entry to nlmon event, the processor copies both */
+    convert_entry(wmi_entry, &metadata, &event);
+    atomic_fetch_add(&bridge_state.events_converted, 1);
     
     /* Submit to event processor */
-    submitted = event_processor_submit(bridge_state.event_processor, &event);
-    if (!submitted) {
-        /* Cleanup on submission failure */
-        if (event.data) {
-            free(event.data);
-        }
-        if (event.user_data) {
-            free(event.user_data);
-        }
+    if (!event_processor_submit(bridge_state.event_processor, &event)) {
         return -3;
     }
     
@@ -253,6 +323,71 @@ int wmi_bridge_submit(const struct wmi_log_entry *wmi_entry)
     return 0;
 }
 
+/**
+ * Submit entries as events, numbered in their source when they have one
+ */
+static int submit_entries(const struct wmi_log_entry *wmi_entries, size_t count,
+                          struct bridge_source *source)
+{
+    size_t submitted = 0;
+    
+    if (!atomic_load(&bridge_state.initialized)) {
+        return -1;
+    }
+    
+    if (!wmi_entries && count) {
+        return -1;
+    }
+    
+    /* If no event processor, just count the conversions and return success */
+    if (!bridge_state.event_processor) {
+        atomic_fetch_add(&bridge_state.events_converted, count);
+        if (source) {
+            source->next_seq += count;
+            atomic_fetch_add(&source->submitted, count);
+        }
+        return (int)count;
+    }
+    
+    pthread_mutex_lock(&bridge_state.mutex);
+    
+    while (count > 0) {
+        size_t n = count < WMI_BRIDGE_BATCH_SIZE ? count : WMI_BRIDGE_BATCH_SIZE;
+        
+        for (size_t i = 0; i < n; i++) {
+            convert_entry(&wmi_entries[i], &bridge_state.batch_metadata[i],
+                          &bridge_state.batch_events[i]);
+            if (source) {
+                bridge_state.batch_metadata[i].source_id = source->id;
+                bridge_state.batch_metadata[i].source_seq = source->next_seq++;
+            }
+        }
+        atomic_fetch_add(&bridge_state.events_converted, n);
+        
+        submitted += event_processor_submit_batch(bridge_state.event_processor, 0,
+                                                  bridge_state.batch_events, n);
+        wmi_entries += n;
+        count -= n;
+    }
+    
+    pthread_mutex_unlock(&bridge_state.mutex);
+    
+    atomic_fetch_add(&bridge_state.events_submitted, submitted);
+    if (source) {
+        atomic_fetch_add(&source->submitted, submitted);
+    }
+    
+    return (int)submitted;
+}
+
+/**
+ * Submit an array of WMI log entries as events
+ */
+int wmi_bridge_submit_batch(const struct wmi_log_entry *wmi_entries, size_t count)
+{
+    return submit_entries(wmi_entries, count, NULL);
+}
+
 /**
  * Get WMI bridge statistics
  */
@@ -279,15 +414,34 @@ int wmi_bridge_get_stats(uint64_t *events_converted,
     return 0;
 }
 
+/**
+ * Submit the entries parsed by the log reader callback of a source
+ */
+static void wmi_bridge_log_flush(void *user_data)
+{
+    struct bridge_source *source = user_data;
+    
+    if (source->pending_count > 0) {
+        const char *stage = nlmon_heartbeat_enter("wmi-submit");
+    
+        submit_entries(source->pending, source->pending_count, source);
+        source->pending_count = 0;
+        nlmon_heartbeat_leave(stage);
+    }
+}
+
 /**
  * WMI log reader callback for event bridge integration
  * 
  * This callback is invoked by the WMI log reader for each parsed line.
- * It parses the line into a WMI log entry and submits it as an event.
+ * It parses the line into the next pending WMI log entry. The entries
+ * are submitted as a batch when the batch fills up or the reader has
+ * handed over everything it read.
  */
 static int wmi_bridge_log_callback(const char *line, void *user_data)
 {
-    struct wmi_log_entry entry;
+    struct bridge_source *source = user_data;
+    struct wmi_log_entry *entry;
     int ret;
     
     if (!line) {
@@ -295,21 +449,107 @@ static int wmi_bridge_log_callback(const char *line, void *user_data)
     }
     
     /* Parse the log line into a WMI entry */
-    memset(&entry, 0, sizeof(entry));
-    ret = wmi_parse_log_line(line, &entry);
+    entry = &source->pending[source->pending_count];
+    ret = wmi_parse_log_line(line, entry);
     if (ret < 0) {
         /* Parsing failed - not a WMI line or malformed */
         return 0; /* Continue processing other lines */
     }
     
-    /* Submit the parsed entry as an event */
-    ret = wmi_bridge_submit(&entry);
-    if (ret < 0) {
-        /* Event submission failed */
-        return ret;
+    atomic_fetch_add(&source->entries, 1);
+    if (++source->pending_count == WMI_BRIDGE_BATCH_SIZE) {
+        wmi_bridge_log_flush(source);
+    }
+    
+    return 0;
+}
+
+/**
+ * Create a source reading log_source, not yet running
+ */
+static int source_create(uint32_t id, const char *log_source, int follow_mode,
+                         struct bridge_source **out)
+{
+    struct wmi_log_config log_config;
+    struct bridge_source *source;
+    
+    source = calloc(1, sizeof(*source));
+    if (!source) {
+        return -2;
+    }
+    
+    source->id = id;
+    source->log_source = strdup(log_source);
+    if (!source->log_source) {
+        goto err_free;
+    }
+    
+    /* Configure WMI log reader */
+    memset(&log_config, 0, sizeof(log_config));
+    log_config.log_source = log_source;
+    log_config.follow_mode = follow_mode;
+    log_config.buffer_size = 4096;
+    log_config.callback = wmi_bridge_log_callback;
+    log_config.flush = wmi_bridge_log_flush;
+    log_config.user_data = source;
+    
+    source->reader = wmi_log_reader_create(&log_config);
+    if (!source->reader) {
+        goto err_free_name;
     }
     
+    *out = source;
     return 0;
+    
+err_free_name:
+    free(source->log_source);
+err_free:
+    free(source);
+    return -2;
+}
+
+/**
+ * Read a source until it is exhausted or stopped
+ */
+static int source_run(struct bridge_source *source)
+{
+    int ret;
+    
+    atomic_store(&source->running, true);
+    ret = wmi_log_reader_run(source->reader);
+    
+    /* Entries of a block cut short by a stop */
+    wmi_bridge_log_flush(source);
+    atomic_store(&source->running, false);
+    
+    return ret;
+}
+
+static void *source_thread(void *arg)
+{
+    nlmon_heartbeat_register("wmi-bridge", NULL, NULL);
+    source_run(arg);
+    nlmon_heartbeat_unregister();
+    return NULL;
+}
+
+/**
+ * Stop a source, wait for its thread and free it
+ */
+static void source_destroy(struct bridge_source *source)
+{
+    if (!source) {
+        return;
+    }
+    
+    wmi_log_reader_interrupt(source->reader);
+    if (source->thread_started) {
+        pthread_join(source->thread, NULL);
+    }
+    
+    wmi_log_reader_destroy(source->reader);
+    free(source->log_source);
+    free(source);
 }
 
 /**
@@ -325,7 +565,7 @@ static int wmi_bridge_log_callback(const char *line, void *user_data)
  */
 int wmi_bridge_start_monitoring(const char *log_source, int follow_mode)
 {
-    struct wmi_log_config log_config;
+    struct bridge_source *source, *old;
     int ret;
     
     if (!atomic_load(&bridge_state.initialized)) {
@@ -336,24 +576,98 @@ int wmi_bridge_start_monitoring(const char *log_source, int follow_mode)
         return -1;
     }
     
-    /* Configure WMI log reader */
-    memset(&log_config, 0, sizeof(log_config));
-    log_config.log_source = log_source;
-    log_config.follow_mode = follow_mode;
-    log_config.buffer_size = 4096;
-    log_config.callback = wmi_bridge_log_callback;
-    log_config.user_data = bridge_state.user_data;
-    
     /* Initialize log reader */
-    ret = wmi_log_reader_init(&log_config);
+    ret = source_create(0, log_source, follow_mode, &source);
     if (ret < 0) {
         return ret;
     }
     
+    /* The source of an earlier call stays stoppable until replaced */
+    old = atomic_exchange(&bridge_state.sources[0], source);
+    source_destroy(old);
+    
     /* Start reading logs (this will block until stopped or EOF) */
-    ret = wmi_log_reader_start();
+    return source_run(source);
+}
+
+/**
+ * Add a log source read on a thread of its own
+ */
+int wmi_bridge_add_source(const char *log_source, int follow_mode)
+{
+    struct bridge_source *source;
+    uint32_t id;
+    int ret;
     
-    return ret;
+    if (!atomic_load(&bridge_state.initialized) || !log_source) {
+        return -1;
+    }
+    
+    pthread_mutex_lock(&bridge_state.mutex);
+    
+    for (id = 1; id <= WMI_BRIDGE_MAX_SOURCES; id++) {
+        if (!atomic_load(&bridge_state.sources[id])) {
+            break;
+        }
+    }
+    if (id > WMI_BRIDGE_MAX_SOURCES) {
+        pthread_mutex_unlock(&bridge_state.mutex);
+        return -1;
+    }
+    
+    ret = source_create(id, log_source, follow_mode, &source);
+    if (ret < 0) {
+        pthread_mutex_unlock(&bridge_state.mutex);
+        return ret;
+    }
+    
+    /* Running before the thread starts, so it is never seen idle early */
+    atomic_store(&source->running, true);
+    if (pthread_create(&source->thread, NULL, source_thread, source) != 0) {
+        pthread_mutex_unlock(&bridge_state.mutex);
+        source_destroy(source);
+        return -3;
+    }
+    source->thread_started = true;
+    atomic_store(&bridge_state.sources[id], source);
+    
+    pthread_mutex_unlock(&bridge_state.mutex);
+    
+    return (int)id;
+}
+
+/**
+ * Get the statistics of a log source
+ */
+int wmi_bridge_get_source_stats(int source_id, struct wmi_bridge_source_stats *stats)
+{
+    struct bridge_source *source;
+    struct wmi_error_stats error_stats;
+    struct wmi_log_stats log_stats;
+    
+    if (!stats || source_id < 0 || source_id > WMI_BRIDGE_MAX_SOURCES) {
+        return -1;
+    }
+    
+    source = atomic_load(&bridge_state.sources[source_id]);
+    if (!source) {
+        return -1;
+    }
+    
+    wmi_log_reader_read_stats(source->reader, &log_stats, &error_stats);
+    
+    memset(stats, 0, sizeof(*stats));
+    stats->source_id = source->id;
+    stats->log_source = source->log_source;
+    stats->running = atomic_load(&source->running);
+    stats->lines_read = log_stats.lines_read;
+    stats->lines_dropped = log_stats.lines_dropped;
+    stats->bytes_read = log_stats.bytes_read;
+    stats->entries = atomic_load(&source->entries);
+    stats->entries_submitted = atomic_load(&source->submitted);
+    stats->errors = error_stats.total_errors;
+    
+    return 0;
 }
 
 /**
@@ -361,7 +675,13 @@ int wmi_bridge_start_monitoring(const char *log_source, int follow_mode)
  */
 void wmi_bridge_stop_monitoring(void)
 {
-    wmi_log_reader_stop();
+    for (int i = 0; i <= WMI_BRIDGE_MAX_SOURCES; i++) {
+        struct bridge_source *source = atomic_load(&bridge_state.sources[i]);
+        
+        if (source) {
+            wmi_log_reader_interrupt(source->reader);
+        }
+    }
 }
 
 /**
@@ -375,7 +695,9 @@ void wmi_bridge_cleanup(void)
     
     /* Stop monitoring if active */
     wmi_bridge_stop_monitoring();
-    wmi_log_reader_cleanup();
+    for (int i = 0; i <= WMI_BRIDGE_MAX_SOURCES; i++) {
+        source_destroy(atomic_exchange(&bridge_state.sources[i], NULL));
+    }
     
     pthread_mutex_lock(&bridge_state.mutex);
     
@@ -11,38 +11,56 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/stat.h>
-#include <sys/select.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
 #include <time.h>
 
 #define DEFAULT_BUFFER_SIZE 4096
 #define MAX_LINE_LENGTH 8192
-#define FOLLOW_POLL_INTERVAL_MS 100
+#define READ_CHUNK_SIZE 65536
+#define FOLLOW_POLL_INTERVAL_MS 100     /* Without inotify */
+#define FOLLOW_RESCAN_INTERVAL_MS 1000  /* With inotify, for missed rotations */
+#define POLL_BUDGET_READS 16            /* Chunks per wmi_log_reader_poll() */
+
+#define FILE_WATCH_EVENTS (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+#define DIR_WATCH_EVENTS (IN_CREATE | IN_MOVED_TO)
 
 /**
  * Internal reader state
  */
-struct wmi_reader_state {
+struct wmi_log_reader {
     struct wmi_log_config config;
-    FILE *fp;
     int fd;
     int is_stdin;
     int is_running;
-    char *line_buffer;
+    char *line_buffer;           /* Line split across reads */
     size_t buffer_capacity;
     size_t buffer_used;
+    int line_overflow;           /* Buffered line did not fit */
+    char *chunk;                 /* READ_CHUNK_SIZE bytes per read() */
     struct wmi_log_stats stats;
     struct wmi_error_stats error_stats;  /* Error statistics */
     ino_t inode;                 /* For file rotation detection */
     off_t last_pos;              /* Last read position */
+    int inotify_fd;              /* Wakes the follower, -1 to poll */
+    int file_wd;                 /* Watch on the file */
+    int wake_fd;                 /* eventfd, wakes the reader to stop */
+    
+    /* Statistics as of the last block, for other threads */
+    pthread_mutex_t snapshot_lock;
+    struct wmi_log_stats stats_snapshot;
+    struct wmi_error_stats error_snapshot;
 };
 
-static struct wmi_reader_state *g_reader = NULL;
+static struct wmi_log_reader *g_reader = NULL;
 
 /**
  * Check if file has been rotated
  */
-static int check_file_rotation(struct wmi_reader_state *reader)
+static int check_file_rotation(struct wmi_log_reader *reader)
 {
     struct stat st;
     
@@ -68,19 +86,55 @@ static int check_file_rotation(struct wmi_reader_state *reader)
 }
 
 /**
- * Reopen file after rotation
+ * Watch the file being followed, replacing the watch on the one before
  */
-static int reopen_file(struct wmi_reader_state *reader)
+static void watch_file(struct wmi_log_reader *reader)
 {
-    struct stat st;
+    if (reader->inotify_fd < 0) {
+        return;
+    }
+    
+    /* Removed already when the old file was deleted */
+    if (reader->file_wd >= 0) {
+        inotify_rm_watch(reader->inotify_fd, reader->file_wd);
+    }
+    
+    reader->file_wd = inotify_add_watch(reader->inotify_fd,
+                                        reader->config.log_source,
+                                        FILE_WATCH_EVENTS);
+}
+
+/**
+ * Watch the directory of the file, for the file replacing it on rotation
+ */
+static void watch_directory(struct wmi_log_reader *reader)
+{
+    const char *slash = strrchr(reader->config.log_source, '/');
+    char dir[4096];
     
-    if (reader->fp) {
-        fclose(reader->fp);
-        reader->fp = NULL;
+    if (!slash) {
+        snprintf(dir, sizeof(dir), ".");
+    } else if (slash == reader->config.log_source) {
+        snprintf(dir, sizeof(dir), "/");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s",
+                 (int)(slash - reader->config.log_source),
+                 reader->config.log_source);
     }
     
-    reader->fp = fopen(reader->config.log_source, "r");
-    if (!reader->fp) {
+    inotify_add_watch(reader->inotify_fd, dir, DIR_WATCH_EVENTS);
+}
+
+/**
+ * Reopen file after rotation, keeping the old one if that fails
+ */
+static int reopen_file(struct wmi_log_reader *reader)
+{
+    struct stat st;
+    int fd;
+    
+    fd = open(reader->config.log_source, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         int err_code = (errno == ENOENT) ? WMI_ERR_FILE_NOT_FOUND :
                        (errno == EACCES) ? WMI_ERR_PERMISSION_DENIED :
                        WMI_ERR_IO_ERROR;
@@ -91,13 +145,15 @@ static int reopen_file(struct wmi_reader_state *reader)
         return err_code;
     }
     
-    reader->fd = fileno(reader->fp);
+    close(reader->fd);
+    reader->fd = fd;
     
     if (fstat(reader->fd, &st) == 0) {
         reader->inode = st.st_ino;
     }
     
     reader->last_pos = 0;
+    watch_file(reader);
     
     WMI_LOG_INFO(WMI_SUCCESS, "File reopened after rotation");
     
@@ -107,7 +163,7 @@ static int reopen_file(struct wmi_reader_state *reader)
 /**
  * Process a complete line through callback
  */
-static int process_line(struct wmi_reader_state *reader, const char *line)
+static int process_line(struct wmi_log_reader *reader, const char *line)
 {
     int ret;
     
@@ -125,208 +181,368 @@ static int process_line(struct wmi_reader_state *reader, const char *line)
     return 0;
 }
 
+/**
+ * Hand a line of len bytes to the callback, line[len] is overwritten
+ */
+static void emit_line(struct wmi_log_reader *reader, char *line, size_t len)
+{
+    /* Remove trailing carriage return */
+    if (len > 0 && line[len - 1] == '\r') {
+        len--;
+    }
+    if (len == 0) {
+        return;
+    }
+    line[len] = '\0';
+    
+    if (process_line(reader, line) < 0) {
+        /* Callback error, but continue processing */
+        WMI_LOG_WARNING(WMI_ERR_CALLBACK_FAILED, "Callback failed, continuing");
+        wmi_error_stats_record(&reader->error_stats, WMI_ERR_CALLBACK_FAILED,
+                              "Line processing callback failed");
+    }
+}
+
+/**
+ * Add part of a line to the line buffer
+ */
+static void buffer_line(struct wmi_log_reader *reader, const char *data, size_t len)
+{
+    size_t room = reader->buffer_capacity - 1 - reader->buffer_used;
+    
+    if (len > room) {
+        len = room;
+        reader->line_overflow = 1;
+    }
+    memcpy(reader->line_buffer + reader->buffer_used, data, len);
+    reader->buffer_used += len;
+}
+
+/**
+ * Hand the line in the line buffer to the callback. Lines too long for
+ * it are dropped from stdin and truncated from files.
+ */
+static void flush_line(struct wmi_log_reader *reader)
+{
+    if (reader->line_overflow && reader->is_stdin) {
+        if (reader->stats.lines_dropped == 0) {
+            WMI_LOG_WARNING(WMI_ERR_BUFFER_FULL, "Line buffer full, dropping line");
+        }
+        reader->stats.lines_dropped++;
+        wmi_error_stats_record(&reader->error_stats, WMI_ERR_BUFFER_FULL,
+                              "Line buffer overflow");
+    } else {
+        if (reader->line_overflow) {
+            WMI_LOG_WARNING_FMT(WMI_ERR_TRUNCATED_LINE,
+                               "Line truncated at %zu bytes", reader->buffer_used);
+            wmi_error_stats_record(&reader->error_stats, WMI_ERR_TRUNCATED_LINE,
+                                  "Line exceeds maximum length");
+        }
+        emit_line(reader, reader->line_buffer, reader->buffer_used);
+    }
+    
+    reader->buffer_used = 0;
+    reader->line_overflow = 0;
+}
+
+/**
+ * Publish the statistics for wmi_log_reader_read_stats()
+ */
+static void publish_stats(struct wmi_log_reader *reader)
+{
+    pthread_mutex_lock(&reader->snapshot_lock);
+    reader->stats_snapshot = reader->stats;
+    reader->error_snapshot = reader->error_stats;
+    pthread_mutex_unlock(&reader->snapshot_lock);
+}
+
+/**
+ * Tell the callback that a block of lines is complete
+ */
+static void end_block(struct wmi_log_reader *reader)
+{
+    if (reader->config.flush) {
+        reader->config.flush(reader->config.user_data);
+    }
+    publish_stats(reader);
+}
+
+/**
+ * Hand on a last line without a newline
+ */
+static void flush_last_line(struct wmi_log_reader *reader)
+{
+    if (reader->buffer_used > 0 || reader->line_overflow) {
+        flush_line(reader);
+        end_block(reader);
+    }
+}
+
+/**
+ * Split a chunk into lines. Lines wholly inside the chunk are handed to
+ * the callback where they are, only a line split across reads is copied.
+ */
+static void split_lines(struct wmi_log_reader *reader, char *data, size_t len)
+{
+    char *p = data, *end = data + len;
+    
+    while (p < end && reader->is_running) {
+        char *nl = memchr(p, '\n', end - p);
+        
+        if (!nl) {
+            buffer_line(reader, p, end - p);
+            break;
+        }
+        
+        if (reader->buffer_used || reader->line_overflow ||
+            (size_t)(nl - p) >= reader->buffer_capacity) {
+            buffer_line(reader, p, nl - p);
+            flush_line(reader);
+        } else {
+            emit_line(reader, p, nl - p);
+        }
+        p = nl + 1;
+    }
+    
+    end_block(reader);
+}
+
+/**
+ * Read and split what is available, at most max_reads chunks (0 for no
+ * limit). Returns WMI_LOG_POLL_WAIT at the end of what there is,
+ * WMI_LOG_POLL_MORE if the limit was reached first, negative on error.
+ */
+static int read_available(struct wmi_log_reader *reader, unsigned int max_reads)
+{
+    unsigned int reads = 0;
+    
+    while (reader->is_running) {
+        ssize_t n;
+        
+        if (max_reads && reads++ == max_reads) {
+            return WMI_LOG_POLL_MORE;
+        }
+        
+        n = read(reader->fd, reader->chunk, READ_CHUNK_SIZE);
+        if (n > 0) {
+            reader->stats.bytes_read += n;
+            reader->error_stats.total_operations++;
+            reader->last_pos += n;
+            split_lines(reader, reader->chunk, n);
+            continue;
+        }
+        
+        if (n == 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
+            return WMI_LOG_POLL_WAIT;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        
+        /* I/O error */
+        WMI_LOG_ERROR_FMT(WMI_ERR_IO_ERROR, "I/O error reading from %s",
+                         reader->config.log_source);
+        wmi_error_stats_record(&reader->error_stats, WMI_ERR_IO_ERROR,
+                              "File read error");
+        return WMI_ERR_IO_ERROR;
+    }
+    
+    return 0;
+}
+
+/**
+ * Sleep until the file may have changed, the reader is stopped or
+ * timeout_ms passed
+ */
+static void wait_for_change(struct wmi_log_reader *reader, int watch_fd,
+                            int timeout_ms)
+{
+    struct pollfd fds[2];
+    nfds_t nfds = 0;
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    uint64_t count;
+    
+    if (watch_fd >= 0) {
+        fds[nfds].fd = watch_fd;
+        fds[nfds++].events = POLLIN;
+    }
+    if (reader->wake_fd >= 0) {
+        fds[nfds].fd = reader->wake_fd;
+        fds[nfds++].events = POLLIN;
+    }
+    
+    if (poll(fds, nfds, timeout_ms) <= 0) {
+        return;
+    }
+    
+    /* Whatever changed, the caller reads on and checks for rotation */
+    if (reader->inotify_fd >= 0 && watch_fd == reader->inotify_fd) {
+        while (read(reader->inotify_fd, events, sizeof(events)) > 0)
+            ;
+    }
+    if (reader->wake_fd >= 0) {
+        /* A stop shows in is_running, only the count is cleared here */
+        ssize_t n = read(reader->wake_fd, &count, sizeof(count));
+        (void)n;
+    }
+}
+
 /**
  * Read and process lines from file
+ *
+ * The file is read in blocks of READ_CHUNK_SIZE and split with memchr().
+ * In follow mode the reader sleeps on inotify until the file is written,
+ * moved or deleted or a file appears in its directory, then reads what
+ * was appended and checks for rotation. Without inotify it polls every
+ * FOLLOW_POLL_INTERVAL_MS.
  */
-static int read_file_lines(struct wmi_reader_state *reader)
+static int read_file_lines(struct wmi_log_reader *reader)
 {
-    char line[MAX_LINE_LENGTH];
     int ret = 0;
     
     while (reader->is_running) {
-        /* Check for file rotation in follow mode */
-        if (reader->config.follow_mode && check_file_rotation(reader)) {
-            int reopen_ret = reopen_file(reader);
-            if (reopen_ret < 0) {
-                /* Wait and retry */
-                usleep(FOLLOW_POLL_INTERVAL_MS * 1000);
-                continue;
-            }
+        ret = read_available(reader, 0);
+        if (ret < 0 || !reader->config.follow_mode) {
+            break;
         }
         
-        /* Try to read a line */
-        if (fgets(line, sizeof(line), reader->fp) == NULL) {
-            if (feof(reader->fp)) {
-                if (reader->config.follow_mode) {
-                    /* In follow mode, wait for more data */
-                    clearerr(reader->fp);
-                    usleep(FOLLOW_POLL_INTERVAL_MS * 1000);
-                    continue;
-                } else {
-                    /* Normal EOF, we're done */
-                    break;
-                }
-            } else if (ferror(reader->fp)) {
-                /* I/O error */
-                WMI_LOG_ERROR_FMT(WMI_ERR_IO_ERROR, 
-                                 "I/O error reading from %s", 
-                                 reader->config.log_source);
-                wmi_error_stats_record(&reader->error_stats, WMI_ERR_IO_ERROR,
-                                      "File read error");
-                ret = WMI_ERR_IO_ERROR;
-                break;
-            }
+        /* A rotated file was read to its end above, go on with the new one */
+        if (check_file_rotation(reader) && reopen_file(reader) == 0) {
+            continue;
+        }
+        
+        if (reader->inotify_fd >= 0) {
+            wait_for_change(reader, reader->inotify_fd, FOLLOW_RESCAN_INTERVAL_MS);
         } else {
-            /* Successfully read a line */
-            size_t len = strlen(line);
-            reader->stats.bytes_read += len;
-            reader->error_stats.total_operations++;
-            reader->last_pos = ftell(reader->fp);
-            
-            /* Check for truncated line */
-            if (len >= MAX_LINE_LENGTH - 1 && line[len - 1] != '\n') {
-                WMI_LOG_WARNING_FMT(WMI_ERR_TRUNCATED_LINE,
-                                   "Line truncated at %zu bytes", len);
-                wmi_error_stats_record(&reader->error_stats, 
-                                      WMI_ERR_TRUNCATED_LINE,
-                                      "Line exceeds maximum length");
-            }
-            
-            /* Remove trailing newline */
-            if (len > 0 && line[len - 1] == '\n') {
-                line[len - 1] = '\0';
-                len--;
-            }
-            if (len > 0 && line[len - 1] == '\r') {
-                line[len - 1] = '\0';
-                len--;
-            }
-            
-            /* Process the line */
-            if (len > 0) {
-                ret = process_line(reader, line);
-                if (ret < 0) {
-                    /* Callback error, but continue processing */
-                    WMI_LOG_WARNING(WMI_ERR_CALLBACK_FAILED, 
-                                   "Callback failed, continuing");
-                    wmi_error_stats_record(&reader->error_stats,
-                                          WMI_ERR_CALLBACK_FAILED,
-                                          "Line processing callback failed");
-                    ret = 0;
-                }
-            }
+            wait_for_change(reader, -1, FOLLOW_POLL_INTERVAL_MS);
         }
     }
     
+    /* A last line without a newline */
+    flush_last_line(reader);
+    
     return ret;
 }
 
 /**
- * Read and process lines from stdin with non-blocking I/O
+ * Read and split what stdin has, at most max_reads chunks (0 for no
+ * limit). Returns WMI_LOG_POLL_WAIT when it would block,
+ * WMI_LOG_POLL_MORE if the limit was reached first, WMI_LOG_POLL_DONE
+ * at EOF, negative on error.
  */
-static int read_stdin_lines(struct wmi_reader_state *reader)
+static int read_stdin_available(struct wmi_log_reader *reader, unsigned int max_reads)
 {
-    fd_set readfds;
-    struct timeval tv;
-    int ret = 0;
-    
-    /* Set stdin to non-blocking mode */
-    int flags = fcntl(reader->fd, F_GETFL, 0);
-    fcntl(reader->fd, F_SETFL, flags | O_NONBLOCK);
+    unsigned int reads = 0;
     
     while (reader->is_running) {
-        FD_ZERO(&readfds);
-        FD_SET(reader->fd, &readfds);
+        ssize_t n;
         
-        /* Timeout for select */
-        tv.tv_sec = 0;
-        tv.tv_usec = FOLLOW_POLL_INTERVAL_MS * 1000;
-        
-        ret = select(reader->fd + 1, &readfds, NULL, NULL, &tv);
+        if (max_reads && reads++ == max_reads) {
+            return WMI_LOG_POLL_MORE;
+        }
         
-        if (ret < 0) {
-            if (errno == EINTR) {
-                continue;
-            }
-            WMI_LOG_ERROR(WMI_ERR_IO_ERROR, "select() failed on stdin");
-            wmi_error_stats_record(&reader->error_stats, WMI_ERR_IO_ERROR,
-                                  "select() failed");
-            return WMI_ERR_IO_ERROR;
+        n = read(reader->fd, reader->chunk, READ_CHUNK_SIZE);
+        if (n > 0) {
+            reader->stats.bytes_read += n;
+            reader->error_stats.total_operations++;
+            split_lines(reader, reader->chunk, n);
+            continue;
         }
         
-        if (ret == 0) {
-            /* Timeout, continue */
+        if (n == 0) {
+            return WMI_LOG_POLL_DONE;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return WMI_LOG_POLL_WAIT;
+        }
+        if (errno == EINTR) {
             continue;
         }
         
-        if (FD_ISSET(reader->fd, &readfds)) {
-            char chunk[1024];
-            ssize_t n = read(reader->fd, chunk, sizeof(chunk) - 1);
-            
-            if (n < 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    continue;
-                }
-                WMI_LOG_ERROR(WMI_ERR_IO_ERROR, "read() failed on stdin");
-                wmi_error_stats_record(&reader->error_stats, WMI_ERR_IO_ERROR,
-                                      "read() failed");
-                return WMI_ERR_IO_ERROR;
-            }
-            
-            if (n == 0) {
-                /* EOF on stdin */
-                break;
-            }
-            
-            chunk[n] = '\0';
-            reader->stats.bytes_read += n;
-            reader->error_stats.total_operations++;
-            
-            /* Process chunk character by character, building lines */
-            for (ssize_t i = 0; i < n; i++) {
-                char c = chunk[i];
-                
-                if (c == '\n' || c == '\r') {
-                    /* Complete line */
-                    if (reader->buffer_used > 0) {
-                        reader->line_buffer[reader->buffer_used] = '\0';
-                        ret = process_line(reader, reader->line_buffer);
-                        reader->buffer_used = 0;
-                        
-                        if (ret < 0) {
-                            WMI_LOG_WARNING(WMI_ERR_CALLBACK_FAILED,
-                                           "Callback failed, continuing");
-                            wmi_error_stats_record(&reader->error_stats,
-                                                  WMI_ERR_CALLBACK_FAILED,
-                                                  "Line processing callback failed");
-                            ret = 0; /* Continue on callback error */
-                        }
-                    }
-                } else {
-                    /* Add character to buffer */
-                    if (reader->buffer_used < reader->buffer_capacity - 1) {
-                        reader->line_buffer[reader->buffer_used++] = c;
-                    } else {
-                        /* Buffer overflow, drop the line */
-                        if (reader->stats.lines_dropped == 0) {
-                            WMI_LOG_WARNING(WMI_ERR_BUFFER_FULL,
-                                           "Line buffer full, dropping line");
-                        }
-                        reader->stats.lines_dropped++;
-                        wmi_error_stats_record(&reader->error_stats,
-                                              WMI_ERR_BUFFER_FULL,
-                                              "Line buffer overflow");
-                        reader->buffer_used = 0;
-                    }
-                }
-            }
+        WMI_LOG_ERROR(WMI_ERR_IO_ERROR, "read() failed on stdin");
+        wmi_error_stats_record(&reader->error_stats, WMI_ERR_IO_ERROR,
+                              "read() failed");
+        return WMI_ERR_IO_ERROR;
+    }
+    
+    return WMI_LOG_POLL_WAIT;
+}
+
+/**
+ * Read and process lines from stdin with non-blocking I/O
+ */
+static int read_stdin_lines(struct wmi_log_reader *reader)
+{
+    int ret = 0;
+    
+    /* Set stdin to non-blocking mode */
+    int flags = fcntl(reader->fd, F_GETFL, 0);
+    fcntl(reader->fd, F_SETFL, flags | O_NONBLOCK);
+    
+    while (reader->is_running) {
+        ret = read_stdin_available(reader, 0);
+        if (ret != WMI_LOG_POLL_WAIT) {
+            break;
         }
+        
+        /* Without an eventfd wake up now and then to see if stopped */
+        wait_for_change(reader, reader->fd,
+                        reader->wake_fd >= 0 ? -1 : FOLLOW_POLL_INTERVAL_MS);
     }
     
     /* Process any remaining buffered data */
-    if (reader->buffer_used > 0) {
-        reader->line_buffer[reader->buffer_used] = '\0';
-        process_line(reader, reader->line_buffer);
-        reader->buffer_used = 0;
+    flush_last_line(reader);
+    
+    return ret < 0 ? ret : 0;
+}
+
+/**
+ * Free a reader and close its descriptors
+ */
+static void reader_free(struct wmi_log_reader *reader)
+{
+    if (!reader) {
+        return;
     }
     
-    return ret;
+    reader->is_running = 0;
+    
+    if (reader->fd >= 0 && !reader->is_stdin) {
+        close(reader->fd);
+    }
+    
+    if (reader->inotify_fd >= 0) {
+        close(reader->inotify_fd);
+    }
+    
+    if (reader->wake_fd >= 0) {
+        close(reader->wake_fd);
+    }
+    
+    pthread_mutex_destroy(&reader->snapshot_lock);
+    free(reader->chunk);
+    
+    if (reader->line_buffer) {
+        free(reader->line_buffer);
+    }
+    
+    if (reader->config.log_source) {
+        free((void *)reader->config.log_source);
+    }
+    
+    free(reader);
 }
 
-int wmi_log_reader_init(struct wmi_log_config *config)
+/**
+ * Allocate a reader and open its log source
+ */
+static int reader_open(const struct wmi_log_config *config, struct wmi_log_reader **out)
 {
+    struct wmi_log_reader *reader;
     struct stat st;
     
+    *out = NULL;
+    
     if (!config) {
         WMI_LOG_ERROR(WMI_ERR_NULL_POINTER, "config is NULL");
         return WMI_ERR_NULL_POINTER;
@@ -342,137 +558,271 @@ int wmi_log_reader_init(struct wmi_log_config *config)
         return WMI_ERR_INVALID_CONFIG;
     }
     
-    /* Cleanup any existing reader */
-    if (g_reader) {
-        wmi_log_reader_cleanup();
-    }
-    
     /* Allocate reader state */
-    g_reader = calloc(1, sizeof(struct wmi_reader_state));
-    if (!g_reader) {
+    reader = calloc(1, sizeof(struct wmi_log_reader));
+    if (!reader) {
         WMI_LOG_ERROR(WMI_ERR_NO_MEMORY, "Failed to allocate reader state");
         return WMI_ERR_NO_MEMORY;
     }
     
+    reader->fd = -1;
+    reader->inotify_fd = -1;
+    reader->file_wd = -1;
+    reader->wake_fd = -1;
+    pthread_mutex_init(&reader->snapshot_lock, NULL);
+    
     /* Initialize error statistics */
-    wmi_error_stats_init(&g_reader->error_stats);
+    wmi_error_stats_init(&reader->error_stats);
     
     /* Copy configuration */
-    g_reader->config = *config;
-    g_reader->config.log_source = strdup(config->log_source);
-    if (!g_reader->config.log_source) {
+    reader->config = *config;
+    reader->config.log_source = strdup(config->log_source);
+    if (!reader->config.log_source) {
         WMI_LOG_ERROR(WMI_ERR_NO_MEMORY, "Failed to duplicate log_source");
-        free(g_reader);
-        g_reader = NULL;
+        reader_free(reader);
         return WMI_ERR_NO_MEMORY;
     }
     
     /* Set default buffer size if not specified */
-    if (g_reader->config.buffer_size == 0) {
-        g_reader->config.buffer_size = DEFAULT_BUFFER_SIZE;
+    if (reader->config.buffer_size == 0) {
+        reader->config.buffer_size = DEFAULT_BUFFER_SIZE;
     }
     
-    /* Allocate line buffer */
-    g_reader->buffer_capacity = g_reader->config.buffer_size;
-    g_reader->line_buffer = malloc(g_reader->buffer_capacity);
-    if (!g_reader->line_buffer) {
+    /* Allocate line buffer, files truncate lines at MAX_LINE_LENGTH */
+    reader->is_stdin = strcmp(reader->config.log_source, "-") == 0;
+    reader->buffer_capacity = reader->config.buffer_size;
+    if (!reader->is_stdin && reader->buffer_capacity < MAX_LINE_LENGTH) {
+        reader->buffer_capacity = MAX_LINE_LENGTH;
+    }
+    reader->line_buffer = malloc(reader->buffer_capacity);
+    reader->chunk = malloc(READ_CHUNK_SIZE);
+    if (!reader->line_buffer || !reader->chunk) {
         WMI_LOG_ERROR(WMI_ERR_NO_MEMORY, "Failed to allocate line buffer");
-        free((void *)g_reader->config.log_source);
-        free(g_reader);
-        g_reader = NULL;
+        reader_free(reader);
         return WMI_ERR_NO_MEMORY;
     }
     
+    /* Lets wmi_log_reader_interrupt() interrupt a wait */
+    reader->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    
     /* Open log source */
-    if (strcmp(g_reader->config.log_source, "-") == 0) {
+    if (reader->is_stdin) {
         /* stdin */
-        g_reader->fp = stdin;
-        g_reader->fd = STDIN_FILENO;
-        g_reader->is_stdin = 1;
+        reader->fd = STDIN_FILENO;
         WMI_LOG_INFO(WMI_SUCCESS, "Initialized WMI log reader for stdin");
     } else {
         /* File */
-        g_reader->fp = fopen(g_reader->config.log_source, "r");
-        if (!g_reader->fp) {
+        reader->fd = open(reader->config.log_source, O_RDONLY | O_CLOEXEC);
+        if (reader->fd < 0) {
             int err_code = (errno == ENOENT) ? WMI_ERR_FILE_NOT_FOUND :
                            (errno == EACCES) ? WMI_ERR_PERMISSION_DENIED :
                            WMI_ERR_IO_ERROR;
             WMI_LOG_ERROR_FMT(err_code, "Failed to open file: %s",
-                             g_reader->config.log_source);
-            wmi_error_stats_record(&g_reader->error_stats, err_code,
-                                  g_reader->config.log_source);
-            free(g_reader->line_buffer);
-            free((void *)g_reader->config.log_source);
-            free(g_reader);
-            g_reader = NULL;
+                             reader->config.log_source);
+            reader_free(reader);
             return err_code;
         }
         
-        g_reader->fd = fileno(g_reader->fp);
-        g_reader->is_stdin = 0;
-        
         /* Get inode for rotation detection */
-        if (fstat(g_reader->fd, &st) == 0) {
-            g_reader->inode = st.st_ino;
+        if (fstat(reader->fd, &st) == 0) {
+            reader->inode = st.st_ino;
+        }
+        
+        /* Without inotify the follower polls */
+        if (reader->config.follow_mode) {
+            reader->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (reader->inotify_fd >= 0) {
+                watch_file(reader);
+                watch_directory(reader);
+            }
         }
         
         WMI_LOG_INFO(WMI_SUCCESS, "Initialized WMI log reader for file");
     }
     
-    g_reader->is_running = 0;
-    g_reader->buffer_used = 0;
-    memset(&g_reader->stats, 0, sizeof(g_reader->stats));
+    reader->is_running = 0;
+    reader->buffer_used = 0;
+    memset(&reader->stats, 0, sizeof(reader->stats));
+    publish_stats(reader);
     
+    *out = reader;
     return WMI_SUCCESS;
 }
 
-int wmi_log_reader_start(void)
+struct wmi_log_reader *wmi_log_reader_create(const struct wmi_log_config *config)
+{
+    struct wmi_log_reader *reader;
+    
+    return reader_open(config, &reader) == WMI_SUCCESS ? reader : NULL;
+}
+
+int wmi_log_reader_run(struct wmi_log_reader *reader)
 {
     int ret;
     
-    if (!g_reader) {
+    if (!reader) {
         WMI_LOG_ERROR(WMI_ERR_NOT_INITIALIZED, "Reader not initialized");
         return WMI_ERR_NOT_INITIALIZED;
     }
     
-    if (g_reader->is_running) {
+    if (reader->is_running) {
         WMI_LOG_ERROR(WMI_ERR_ALREADY_RUNNING, "Reader already running");
         return WMI_ERR_ALREADY_RUNNING;
     }
     
-    g_reader->is_running = 1;
+    reader->is_running = 1;
     
-    if (g_reader->is_stdin) {
-        ret = read_stdin_lines(g_reader);
+    if (reader->is_stdin) {
+        ret = read_stdin_lines(reader);
     } else {
-        ret = read_file_lines(g_reader);
+        ret = read_file_lines(reader);
     }
     
-    g_reader->is_running = 0;
+    reader->is_running = 0;
+    publish_stats(reader);
     
     /* Print error statistics if there were errors */
-    if (g_reader->error_stats.total_errors > 0) {
-        wmi_error_stats_print(&g_reader->error_stats, stderr);
+    if (reader->error_stats.total_errors > 0) {
+        wmi_error_stats_print(&reader->error_stats, stderr);
     }
     
     return ret;
 }
 
-void wmi_log_reader_stop(void)
+int wmi_log_reader_watch(struct wmi_log_reader *reader, int *interval_ms)
+{
+    *interval_ms = 0;
+    if (!reader) {
+        return -1;
+    }
+    
+    if (reader->is_stdin) {
+        return reader->fd;
+    }
+    if (!reader->config.follow_mode) {
+        return -1;
+    }
+    
+    /* inotify misses rotations now and then, a timer catches them */
+    *interval_ms = reader->inotify_fd >= 0 ? FOLLOW_RESCAN_INTERVAL_MS :
+                   FOLLOW_POLL_INTERVAL_MS;
+    return reader->inotify_fd;
+}
+
+int wmi_log_reader_poll(struct wmi_log_reader *reader)
+{
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int ret;
+    
+    if (!reader) {
+        WMI_LOG_ERROR(WMI_ERR_NOT_INITIALIZED, "Reader not initialized");
+        return WMI_ERR_NOT_INITIALIZED;
+    }
+    
+    if (reader->is_running) {
+        WMI_LOG_ERROR(WMI_ERR_ALREADY_RUNNING, "Reader already running");
+        return WMI_ERR_ALREADY_RUNNING;
+    }
+    
+    reader->is_running = 1;
+    
+    if (reader->is_stdin) {
+        int flags = fcntl(reader->fd, F_GETFL, 0);
+        
+        if (!(flags & O_NONBLOCK)) {
+            fcntl(reader->fd, F_SETFL, flags | O_NONBLOCK);
+        }
+        ret = read_stdin_available(reader, POLL_BUDGET_READS);
+    } else {
+        /* Whatever changed, what was appended is read below */
+        if (reader->inotify_fd >= 0) {
+            while (read(reader->inotify_fd, events, sizeof(events)) > 0)
+                ;
+        }
+        
+        ret = read_available(reader, POLL_BUDGET_READS);
+        if (ret == WMI_LOG_POLL_WAIT && !reader->config.follow_mode) {
+            ret = WMI_LOG_POLL_DONE;
+        } else if (ret == WMI_LOG_POLL_WAIT && check_file_rotation(reader) &&
+                   reopen_file(reader) == 0) {
+            /* A rotated file was read to its end, go on with the new one */
+            ret = WMI_LOG_POLL_MORE;
+        }
+    }
+    
+    if (ret < 0 || ret == WMI_LOG_POLL_DONE) {
+        flush_last_line(reader);
+    }
+    
+    reader->is_running = 0;
+    publish_stats(reader);
+    return ret;
+}
+
+void wmi_log_reader_interrupt(struct wmi_log_reader *reader)
+{
+    if (reader) {
+        reader->is_running = 0;
+        
+        /* write() is async-signal-safe */
+        if (reader->wake_fd >= 0) {
+            uint64_t one = 1;
+            ssize_t n = write(reader->wake_fd, &one, sizeof(one));
+            (void)n;
+        }
+    }
+}
+
+int wmi_log_reader_read_stats(struct wmi_log_reader *reader, struct wmi_log_stats *stats,
+                              struct wmi_error_stats *error_stats)
+{
+    if (!reader) {
+        return -1;
+    }
+    
+    pthread_mutex_lock(&reader->snapshot_lock);
+    if (stats) {
+        *stats = reader->stats_snapshot;
+    }
+    if (error_stats) {
+        *error_stats = reader->error_snapshot;
+    }
+    pthread_mutex_unlock(&reader->snapshot_lock);
+    return 0;
+}
+
+void wmi_log_reader_destroy(struct wmi_log_reader *reader)
+{
+    reader_free(reader);
+}
+
+int wmi_log_reader_init(struct wmi_log_config *config)
 {
+    /* Cleanup any existing reader */
     if (g_reader) {
-        g_reader->is_running = 0;
+        wmi_log_reader_cleanup();
     }
+    
+    return reader_open(config, &g_reader);
+}
+
+int wmi_log_reader_start(void)
+{
+    return wmi_log_reader_run(g_reader);
+}
+
+void wmi_log_reader_stop(void)
+{
+    wmi_log_reader_interrupt(g_reader);
 }
 
 int wmi_log_reader_get_stats(struct wmi_log_stats *stats)
 {
-    if (!g_reader || !stats) {
+    if (!stats) {
         return -1;
     }
     
-    *stats = g_reader->stats;
-    return 0;
+    return wmi_log_reader_read_stats(g_reader, stats, NULL);
 }
 
 /**
@@ -483,34 +833,15 @@ int wmi_log_reader_get_stats(struct wmi_log_stats *stats)
  */
 int wmi_log_reader_get_error_stats(struct wmi_error_stats *stats)
 {
-    if (!g_reader || !stats) {
+    if (!stats) {
         return -1;
     }
     
-    *stats = g_reader->error_stats;
-    return 0;
+    return wmi_log_reader_read_stats(g_reader, NULL, stats);
 }
 
 void wmi_log_reader_cleanup(void)
 {
-    if (!g_reader) {
-        return;
-    }
-    
-    g_reader->is_running = 0;
-    
-    if (g_reader->fp && !g_reader->is_stdin) {
-        fclose(g_reader->fp);
-    }
-    
-    if (g_reader->line_buffer) {
-        free(g_reader->line_buffer);
-    }
-    
-    if (g_reader->config.log_source) {
-        free((void *)g_reader->config.log_source);
-    }
-    
-    free(g_reader);
+    reader_free(g_reader);
     g_reader = NULL;
 }
@@ -0,0 +1,559 @@
+/**
+ * @file wmi_replay.c
+ * @brief Parallel offline replay of WMI log files
+ *
+ * Chunk k covers the lines starting in [k * chunk_size, (k + 1) *
+ * chunk_size), so every worker finds its own boundaries in the mapped
+ * file. A worker takes the next chunk number, waits until the merge
+ * window reaches it, parses the chunk into the chunk's window slot and
+ * sorts it by timestamp. The merger keeps a heap of the slots in the
+ * window keyed by their next entry and takes the smallest one for as
+ * long as the window is full, moving the window on as its oldest chunk
+ * runs out.
+ */
+
+#include "wmi_replay.h"
+#include "wmi_event_bridge.h"
+#include "wmi_error.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAX_LINE_LENGTH 8192
+#define WAIT_INTERVAL_MS 100    /* Longest wait before checking for a stop */
+
+/* Parsed chunk in a window slot */
+struct replay_chunk {
+    uint64_t index;              /* Chunk held once ready */
+    bool ready;
+    struct wmi_log_entry *entries;
+    uint64_t *keys;              /* Timestamp to merge each entry by */
+    uint32_t *order;             /* Entries sorted by key */
+    size_t count;
+    size_t capacity;
+    size_t next;                 /* Next of order[] to merge */
+};
+
+struct replay {
+    const struct wmi_replay_config *config;
+    const char *data;
+    size_t size;
+    size_t chunk_size;
+    uint64_t chunks;
+    
+    struct replay_chunk *slots;  /* Chunk k in slots[k % window] */
+    size_t window;
+    
+    pthread_mutex_t lock;
+    pthread_cond_t slot_free;
+    pthread_cond_t chunk_ready;
+    uint64_t front;              /* Oldest chunk not merged yet */
+    
+    _Atomic uint64_t next_chunk;
+    _Atomic uint64_t bytes_parsed;
+    _Atomic uint64_t lines;
+    _Atomic uint64_t parse_errors;
+};
+
+static atomic_bool g_replay_stop;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Wait on cond for at most WAIT_INTERVAL_MS, lock held */
+static void wait_interval(pthread_cond_t *cond, pthread_mutex_t *lock)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += WAIT_INTERVAL_MS * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(cond, lock, &ts);
+}
+
+/* Start of the first line starting at or after offset */
+static size_t line_boundary(const struct replay *replay, size_t offset)
+{
+    const char *nl;
+    
+    if (offset == 0 || offset >= replay->size) {
+        return offset < replay->size ? offset : replay->size;
+    }
+    
+    nl = memchr(replay->data + offset - 1, '\n', replay->size - offset + 1);
+    return nl ? (size_t)(nl - replay->data) + 1 : replay->size;
+}
+
+static int chunk_reserve(struct replay_chunk *chunk)
+{
+    size_t capacity = chunk->capacity ? chunk->capacity * 2 : 1024;
+    void *entries, *keys, *order;
+    
+    entries = realloc(chunk->entries, capacity * sizeof(*chunk->entries));
+    if (!entries) {
+        return -1;
+    }
+    chunk->entries = entries;
+    
+    keys = realloc(chunk->keys, capacity * sizeof(*chunk->keys));
+    if (!keys) {
+        return -1;
+    }
+    chunk->keys = keys;
+    
+    order = realloc(chunk->order, capacity * sizeof(*chunk->order));
+    if (!order) {
+        return -1;
+    }
+    chunk->order = order;
+    
+    chunk->capacity = capacity;
+    return 0;
+}
+
+/* Keys of the chunk being sorted, for compare_order() */
+static _Thread_local const uint64_t *sort_keys;
+
+static int compare_order(const void *a, const void *b)
+{
+    uint32_t i = *(const uint32_t *)a, j = *(const uint32_t *)b;
+    
+    if (sort_keys[i] != sort_keys[j]) {
+        return sort_keys[i] < sort_keys[j] ? -1 : 1;
+    }
+    return i < j ? -1 : i > j;
+}
+
+/* Sort the chunk by key, keeping file order among equal keys */
+static void chunk_sort(struct replay_chunk *chunk)
+{
+    bool sorted = true;
+    
+    for (size_t i = 0; i < chunk->count; i++) {
+        chunk->order[i] = (uint32_t)i;
+        if (i > 0 && chunk->keys[i] < chunk->keys[i - 1]) {
+            sorted = false;
+        }
+    }
+    
+    /* Logs are mostly in order already */
+    if (!sorted) {
+        sort_keys = chunk->keys;
+        qsort(chunk->order, chunk->count, sizeof(*chunk->order), compare_order);
+    }
+}
+
+/* Parse the lines of chunk k into its slot */
+static int parse_chunk(struct replay *replay, uint64_t k, struct replay_chunk *chunk)
+{
+    size_t start = line_boundary(replay, k * replay->chunk_size);
+    size_t end = line_boundary(replay, (k + 1) * replay->chunk_size);
+    const char *p = replay->data + start, *stop = replay->data + end;
+    char line[MAX_LINE_LENGTH];
+    uint64_t lines = 0, errors = 0, last_key = 0;
+    size_t untimed = 0;          /* Entries before the first timestamp */
+    bool have_key = false;
+    
+    chunk->count = 0;
+    chunk->next = 0;
+    
+    while (p < stop) {
+        const char *nl = memchr(p, '\n', stop - p);
+        size_t len = (nl ? nl : stop) - p;
+        
+        if (len > 0 && p[len - 1] == '\r') {
+            len--;
+        }
+        if (len >= sizeof(line)) {
+            len = sizeof(line) - 1;
+        }
+        memcpy(line, p, len);
+        line[len] = '\0';
+        p = nl ? nl + 1 : stop;
+        
+        if (len == 0) {
+            continue;
+        }
+        lines++;
+        
+        if (chunk->count == chunk->capacity && chunk_reserve(chunk) < 0) {
+            return WMI_ERR_NO_MEMORY;
+        }
+        
+        struct wmi_log_entry *entry = &chunk->entries[chunk->count];
+        
+        if (wmi_parse_log_line(line, entry) < 0) {
+            errors++;
+            continue;
+        }
+        
+        if (entry->has_timestamp) {
+            last_key = entry->timestamp;
+            if (!have_key) {
+                for (size_t i = 0; i < untimed; i++) {
+                    chunk->keys[i] = last_key;
+                }
+                have_key = true;
+            }
+        } else if (!have_key) {
+            untimed++;
+        }
+        chunk->keys[chunk->count++] = last_key;
+    }
+    
+    chunk_sort(chunk);
+    
+    atomic_fetch_add_explicit(&replay->bytes_parsed, end - start, memory_order_relaxed);
+    atomic_fetch_add_explicit(&replay->lines, lines, memory_order_relaxed);
+    atomic_fetch_add_explicit(&replay->parse_errors, errors, memory_order_relaxed);
+    return 0;
+}
+
+static void *replay_worker(void *arg)
+{
+    struct replay *replay = arg;
+    
+    for (;;) {
+        uint64_t k = atomic_fetch_add(&replay->next_chunk, 1);
+        struct replay_chunk *chunk = &replay->slots[k % replay->window];
+        int ret;
+        
+        if (k >= replay->chunks || atomic_load(&g_replay_stop)) {
+            break;
+        }
+        
+        /* Wait for the merger to be done with the chunk in the slot */
+        pthread_mutex_lock(&replay->lock);
+        while (k >= replay->front + replay->window && !atomic_load(&g_replay_stop)) {
+            wait_interval(&replay->slot_free, &replay->lock);
+        }
+        pthread_mutex_unlock(&replay->lock);
+        
+        if (atomic_load(&g_replay_stop)) {
+            break;
+        }
+        
+        ret = parse_chunk(replay, k, chunk);
+        if (ret < 0) {
+            /* Out of memory: the merger cannot go on without the chunk */
+            WMI_LOG_ERROR(WMI_ERR_NO_MEMORY, "Failed to allocate replay chunk");
+            atomic_store(&g_replay_stop, true);
+        }
+        
+        pthread_mutex_lock(&replay->lock);
+        chunk->index = k;
+        chunk->ready = true;
+        pthread_cond_broadcast(&replay->chunk_ready);
+        pthread_mutex_unlock(&replay->lock);
+    }
+    
+    return NULL;
+}
+
+/* Heap of window slots by their next entry, oldest chunk first on ties */
+static bool heap_less(const struct replay *replay, size_t a, size_t b)
+{
+    const struct replay_chunk *x = &replay->slots[a], *y = &replay->slots[b];
+    uint64_t kx = x->keys[x->order[x->next]], ky = y->keys[y->order[y->next]];
+    
+    return kx != ky ? kx < ky : x->index < y->index;
+}
+
+static void heap_push(const struct replay *replay, size_t *heap, size_t *n, size_t slot)
+{
+    size_t i = (*n)++;
+    
+    heap[i] = slot;
+    while (i > 0 && heap_less(replay, heap[i], heap[(i - 1) / 2])) {
+        size_t parent = (i - 1) / 2, tmp = heap[i];
+        
+        heap[i] = heap[parent];
+        heap[parent] = tmp;
+        i = parent;
+    }
+}
+
+static size_t heap_pop(const struct replay *replay, size_t *heap, size_t *n)
+{
+    size_t top = heap[0], i = 0;
+    
+    heap[0] = heap[--(*n)];
+    for (;;) {
+        size_t l = 2 * i + 1, r = l + 1, min = i, tmp;
+        
+        if (l < *n && heap_less(replay, heap[l], heap[min])) {
+            min = l;
+        }
+        if (r < *n && heap_less(replay, heap[r], heap[min])) {
+            min = r;
+        }
+        if (min == i) {
+            break;
+        }
+        tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+    return top;
+}
+
+static void fill_progress(struct replay *replay, struct wmi_replay_progress *progress,
+                          double start)
+{
+    progress->bytes_total = replay->size;
+    progress->bytes_parsed = atomic_load_explicit(&replay->bytes_parsed, memory_order_relaxed);
+    progress->lines = atomic_load_explicit(&replay->lines, memory_order_relaxed);
+    progress->parse_errors = atomic_load_explicit(&replay->parse_errors, memory_order_relaxed);
+    progress->elapsed = now_seconds() - start;
+    progress->bytes_per_sec = progress->elapsed > 0 ?
+                              progress->bytes_parsed / progress->elapsed : 0;
+    progress->entries_per_sec = progress->elapsed > 0 ?
+                                progress->entries / progress->elapsed : 0;
+}
+
+static void report_progress(struct replay *replay, struct wmi_replay_progress *progress,
+                            double start, double *next_report)
+{
+    const struct wmi_replay_config *config = replay->config;
+    double now = now_seconds();
+    
+    if (!config->progress || now < *next_report) {
+        return;
+    }
+    
+    fill_progress(replay, progress, start);
+    config->progress(progress, config->user_data);
+    *next_report = now + (config->progress_ms ? config->progress_ms :
+                          WMI_REPLAY_DEFAULT_PROGRESS_MS) / 1000.0;
+}
+
+static int bridge_sink(const struct wmi_log_entry *entry, void *user_data)
+{
+    (void)user_data;
+    return wmi_bridge_submit(entry);
+}
+
+/* Merge the parsed chunks in timestamp order into the sink */
+static void merge_chunks(struct replay *replay, struct wmi_replay_progress *progress,
+                         double start)
+{
+    const struct wmi_replay_config *config = replay->config;
+    int (*sink)(const struct wmi_log_entry *, void *) = config->sink ? config->sink : bridge_sink;
+    size_t *heap = replay->window ? calloc(replay->window, sizeof(*heap)) : NULL;
+    size_t heap_size = 0;
+    uint64_t admitted = 0;
+    double next_report = start;
+    
+    if (!heap) {
+        WMI_LOG_ERROR(WMI_ERR_NO_MEMORY, "Failed to allocate replay heap");
+        atomic_store(&g_replay_stop, true);
+        return;
+    }
+    
+    while (!atomic_load(&g_replay_stop)) {
+        /* Fill the window before taking anything from it */
+        while (admitted < replay->chunks && admitted < replay->front + replay->window &&
+               !atomic_load(&g_replay_stop)) {
+            size_t slot = admitted % replay->window;
+            struct replay_chunk *chunk = &replay->slots[slot];
+            
+            pthread_mutex_lock(&replay->lock);
+            while (!(chunk->ready && chunk->index == admitted) &&
+                   !atomic_load(&g_replay_stop)) {
+                wait_interval(&replay->chunk_ready, &replay->lock);
+                if (config->progress) {
+                    pthread_mutex_unlock(&replay->lock);
+                    report_progress(replay, progress, start, &next_report);
+                    pthread_mutex_lock(&replay->lock);
+                }
+            }
+            pthread_mutex_unlock(&replay->lock);
+            
+            if (chunk->count > 0) {
+                heap_push(replay, heap, &heap_size, slot);
+            }
+            admitted++;
+        }
+        
+        if (atomic_load(&g_replay_stop) || (heap_size == 0 && admitted == replay->chunks)) {
+            break;
+        }
+        
+        if (heap_size > 0) {
+            size_t slot = heap_pop(replay, heap, &heap_size);
+            struct replay_chunk *chunk = &replay->slots[slot];
+            
+            if (sink(&chunk->entries[chunk->order[chunk->next]], config->user_data) < 0) {
+                progress->sink_errors++;
+            }
+            progress->entries++;
+            if (++chunk->next < chunk->count) {
+                heap_push(replay, heap, &heap_size, slot);
+            }
+            
+            if ((progress->entries & 1023) == 0) {
+                report_progress(replay, progress, start, &next_report);
+            }
+        }
+        
+        /* Move the window past the chunks that ran out */
+        pthread_mutex_lock(&replay->lock);
+        while (replay->front < admitted) {
+            struct replay_chunk *chunk = &replay->slots[replay->front % replay->window];
+            
+            if (chunk->next < chunk->count) {
+                break;
+            }
+            chunk->ready = false;
+            replay->front++;
+            pthread_cond_broadcast(&replay->slot_free);
+        }
+        pthread_mutex_unlock(&replay->lock);
+    }
+    
+    free(heap);
+}
+
+int wmi_replay_run(const struct wmi_replay_config *config,
+                   struct wmi_replay_progress *result)
+{
+    struct wmi_replay_progress progress = {0};
+    struct replay replay = {0};
+    pthread_t *workers = NULL;
+    unsigned int threads, started = 0;
+    struct stat st;
+    double start = now_seconds();
+    void *map = MAP_FAILED;
+    int fd, ret = WMI_SUCCESS;
+    
+    if (!config || !config->log_source) {
+        WMI_LOG_ERROR(WMI_ERR_INVALID_CONFIG, "log_source is NULL");
+        return WMI_ERR_INVALID_CONFIG;
+    }
+    
+    if (!config->sink && wmi_bridge_get_stats(NULL, NULL, NULL) < 0) {
+        WMI_LOG_ERROR(WMI_ERR_NOT_INITIALIZED, "Event bridge not initialized");
+        return WMI_ERR_NOT_INITIALIZED;
+    }
+    
+    atomic_store(&g_replay_stop, false);
+    
+    fd = open(config->log_source, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        int err_code = (errno == ENOENT) ? WMI_ERR_FILE_NOT_FOUND :
+                       (errno == EACCES) ? WMI_ERR_PERMISSION_DENIED :
+                       WMI_ERR_IO_ERROR;
+        WMI_LOG_ERROR_FMT(err_code, "Failed to open file: %s", config->log_source);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return err_code;
+    }
+    
+    replay.config = config;
+    replay.size = st.st_size;
+    replay.chunk_size = config->chunk_size ? config->chunk_size : WMI_REPLAY_DEFAULT_CHUNK_SIZE;
+    replay.chunks = (replay.size + replay.chunk_size - 1) / replay.chunk_size;
+    
+    if (replay.size > 0) {
+        map = mmap(NULL, replay.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            WMI_LOG_ERROR_FMT(WMI_ERR_IO_ERROR, "Failed to map file: %s", config->log_source);
+            ret = WMI_ERR_IO_ERROR;
+            goto out_close;
+        }
+        madvise(map, replay.size, MADV_SEQUENTIAL);
+        replay.data = map;
+    }
+    
+    threads = config->threads;
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned int)cpus : 1;
+    }
+    if (threads > replay.chunks) {
+        threads = replay.chunks ? (unsigned int)replay.chunks : 1;
+    }
+    
+    replay.window = 2 * (size_t)threads;
+    replay.slots = calloc(replay.window, sizeof(*replay.slots));
+    workers = calloc(threads, sizeof(*workers));
+    if (!replay.slots || !workers) {
+        WMI_LOG_ERROR(WMI_ERR_NO_MEMORY, "Failed to allocate replay state");
+        ret = WMI_ERR_NO_MEMORY;
+        goto out_free;
+    }
+    
+    pthread_mutex_init(&replay.lock, NULL);
+    pthread_cond_init(&replay.slot_free, NULL);
+    pthread_cond_init(&replay.chunk_ready, NULL);
+    
+    for (; started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, replay_worker, &replay) != 0) {
+            WMI_LOG_ERROR(WMI_ERR_RESOURCE_LIMIT, "Failed to create replay thread");
+            ret = WMI_ERR_RESOURCE_LIMIT;
+            atomic_store(&g_replay_stop, true);
+            break;
+        }
+    }
+    
+    if (ret == WMI_SUCCESS) {
+        merge_chunks(&replay, &progress, start);
+    }
+    
+    /* A stop wakes the workers within WAIT_INTERVAL_MS */
+    atomic_store(&g_replay_stop, true);
+    for (unsigned int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    
+    fill_progress(&replay, &progress, start);
+    if (config->progress) {
+        config->progress(&progress, config->user_data);
+    }
+    if (result) {
+        *result = progress;
+    }
+    
+    pthread_cond_destroy(&replay.chunk_ready);
+    pthread_cond_destroy(&replay.slot_free);
+    pthread_mutex_destroy(&replay.lock);
+    
+out_free:
+    for (size_t i = 0; replay.slots && i < replay.window; i++) {
+        free(replay.slots[i].entries);
+        free(replay.slots[i].keys);
+        free(replay.slots[i].order);
+    }
+    free(replay.slots);
+    free(workers);
+    if (map != MAP_FAILED) {
+        munmap(map, replay.size);
+    }
+out_close:
+    close(fd);
+    return ret;
+}
+
+void wmi_replay_stop(void)
+{
+    atomic_store(&g_replay_stop, true);
+}
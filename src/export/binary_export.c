@@ -0,0 +1,449 @@
+/* binary_export.c - Compact binary event export with an mmap reader */
+
+#include "binary_export.h"
+#include "event_processor.h"
+#include "json_buf.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Pending output is written out once it reaches this size */
+#define BINARY_EXPORT_BATCH_BYTES (64 * 1024)
+
+/* Dictionary hash slots, a power of two above BINEXP_MAX_NAMES */
+#define NAME_SLOTS (BINEXP_MAX_NAMES * 2)
+
+#define ALIGN8(x) (((x) + 7) & ~(size_t)7)
+
+_Static_assert(sizeof(struct binexp_event) % 8 == 0, "event records must stay aligned");
+_Static_assert(sizeof(struct binexp_file_header) % 8 == 0, "header must stay aligned");
+
+#define FIELD(f, k) { #f, offsetof(struct binexp_event, f), \
+                      sizeof(((struct binexp_event *)0)->f), k }
+
+/* Layout of struct binexp_event, written to every file */
+static const struct binexp_field schema[] = {
+	FIELD(timestamp, BINEXP_FIELD_UINT),
+	FIELD(sequence, BINEXP_FIELD_UINT),
+	FIELD(event_type, BINEXP_FIELD_UINT),
+	FIELD(message_type, BINEXP_FIELD_UINT),
+	FIELD(interface, BINEXP_FIELD_NAME),
+	FIELD(nl_protocol, BINEXP_FIELD_INT),
+	FIELD(nl_msg_type, BINEXP_FIELD_UINT),
+	FIELD(nl_msg_flags, BINEXP_FIELD_UINT),
+	FIELD(nl_seq, BINEXP_FIELD_UINT),
+	FIELD(nl_pid, BINEXP_FIELD_UINT),
+	FIELD(genl_cmd, BINEXP_FIELD_UINT),
+	FIELD(genl_version, BINEXP_FIELD_UINT),
+	FIELD(genl_family_id, BINEXP_FIELD_UINT),
+	FIELD(genl_family, BINEXP_FIELD_NAME),
+	FIELD(raw_len, BINEXP_FIELD_UINT),
+	FIELD(sample_weight, BINEXP_FIELD_UINT),
+};
+
+#define SCHEMA_FIELDS (sizeof(schema) / sizeof(schema[0]))
+#define HEADER_SIZE ALIGN8(sizeof(struct binexp_file_header) + sizeof(schema))
+
+struct binary_exporter {
+	int fd;
+	struct binary_export_options options;
+	
+	/* Records not yet written */
+	struct json_buf out;
+	
+	/* Dictionary, slots hold id + 1 */
+	char (*names)[BINEXP_NAME_SIZE];
+	uint16_t *slots;
+	uint32_t name_count;
+	
+	/* Statistics */
+	uint64_t events_written;
+	uint64_t bytes_written;
+};
+
+struct binary_reader {
+	const unsigned char *map;
+	size_t size;
+	size_t pos;
+	uint64_t created_ns;
+	const char *names[BINEXP_MAX_NAMES];
+};
+
+static bool write_pending(struct binary_exporter *exporter)
+{
+	size_t done = 0;
+	
+	if (exporter->out.failed) {
+		json_buf_reset(&exporter->out);
+		return false;
+	}
+	
+	while (done < exporter->out.len) {
+		ssize_t n = write(exporter->fd, exporter->out.data + done,
+		                  exporter->out.len - done);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			json_buf_reset(&exporter->out);
+			return false;
+		}
+		done += n;
+	}
+	
+	exporter->bytes_written += done;
+	json_buf_reset(&exporter->out);
+	return true;
+}
+
+/* Append zero padding up to the next 8-byte boundary */
+static void append_padding(struct json_buf *out, size_t len)
+{
+	static const char zeros[8];
+	
+	json_buf_append(out, zeros, ALIGN8(len) - len);
+}
+
+static uint32_t name_hash(const char *name, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	
+	for (size_t i = 0; i < len; i++)
+		hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+	return hash;
+}
+
+/* Dictionary id of name, a name record is appended the first time */
+static uint16_t name_id(struct binary_exporter *exporter, const char *name, size_t size)
+{
+	struct binexp_record rec = { .type = BINEXP_RECORD_NAME };
+	struct binexp_name entry;
+	size_t len = strnlen(name, size);
+	uint32_t slot;
+	uint16_t id;
+	
+	if (len == 0 || len >= BINEXP_NAME_SIZE)
+		return BINEXP_NO_NAME;
+	
+	for (slot = name_hash(name, len) & (NAME_SLOTS - 1);
+	     exporter->slots[slot];
+	     slot = (slot + 1) & (NAME_SLOTS - 1)) {
+		id = exporter->slots[slot] - 1;
+		if (strncmp(exporter->names[id], name, len) == 0 && exporter->names[id][len] == '\0')
+			return id;
+	}
+	
+	if (exporter->name_count == BINEXP_MAX_NAMES)
+		return BINEXP_NO_NAME;
+	
+	id = (uint16_t)exporter->name_count++;
+	memcpy(exporter->names[id], name, len);
+	exporter->names[id][len] = '\0';
+	exporter->slots[slot] = id + 1;
+	
+	entry.id = id;
+	entry.len = (uint16_t)len;
+	rec.length = (uint32_t)ALIGN8(sizeof(rec) + sizeof(entry) + len + 1);
+	json_buf_append(&exporter->out, (const char *)&rec, sizeof(rec));
+	json_buf_append(&exporter->out, (const char *)&entry, sizeof(entry));
+	json_buf_append(&exporter->out, exporter->names[id], len + 1);
+	append_padding(&exporter->out, sizeof(rec) + sizeof(entry) + len + 1);
+	
+	return id;
+}
+
+struct binary_exporter *binary_exporter_create(const char *filename,
+                                               const struct binary_export_options *options)
+{
+	struct binary_exporter *exporter;
+	struct binexp_file_header header;
+	struct timespec ts;
+	
+	if (!filename)
+		return NULL;
+	
+	exporter = calloc(1, sizeof(*exporter));
+	if (!exporter)
+		return NULL;
+	
+	if (options)
+		exporter->options = *options;
+	if (exporter->options.buffer_size == 0)
+		exporter->options.buffer_size = BINARY_EXPORT_BATCH_BYTES;
+	
+	exporter->names = calloc(BINEXP_MAX_NAMES, sizeof(*exporter->names));
+	exporter->slots = calloc(NAME_SLOTS, sizeof(*exporter->slots));
+	if (!exporter->names || !exporter->slots)
+		goto err_free;
+	
+	if (!json_buf_init(&exporter->out, exporter->options.buffer_size + 4096))
+		goto err_free;
+	
+	exporter->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (exporter->fd < 0)
+		goto err_buf;
+	
+	/* Header and schema, written with the first batch */
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, BINEXP_MAGIC, sizeof(header.magic));
+	header.version = BINEXP_VERSION;
+	header.header_size = HEADER_SIZE;
+	header.field_count = SCHEMA_FIELDS;
+	header.event_size = sizeof(struct binexp_event);
+	clock_gettime(CLOCK_REALTIME, &ts);
+	header.created_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+	
+	json_buf_append(&exporter->out, (const char *)&header, sizeof(header));
+	json_buf_append(&exporter->out, (const char *)schema, sizeof(schema));
+	append_padding(&exporter->out, sizeof(header) + sizeof(schema));
+	
+	if (!write_pending(exporter))
+		goto err_close;
+	
+	return exporter;
+	
+err_close:
+	close(exporter->fd);
+	unlink(filename);
+err_buf:
+	json_buf_free(&exporter->out);
+err_free:
+	free(exporter->slots);
+	free(exporter->names);
+	free(exporter);
+	return NULL;
+}
+
+void binary_exporter_destroy(struct binary_exporter *exporter)
+{
+	if (!exporter)
+		return;
+	
+	write_pending(exporter);
+	close(exporter->fd);
+	
+	json_buf_free(&exporter->out);
+	free(exporter->slots);
+	free(exporter->names);
+	free(exporter);
+}
+
+void binexp_event_fill(struct binexp_event *ev, const struct nlmon_event *event)
+{
+	memset(ev, 0, sizeof(*ev));
+	ev->timestamp = event->timestamp;
+	ev->sequence = event->sequence;
+	ev->event_type = event->event_type;
+	ev->message_type = event->message_type;
+	ev->nl_protocol = event->netlink.protocol;
+	ev->nl_msg_type = event->netlink.msg_type;
+	ev->nl_msg_flags = event->netlink.msg_flags;
+	ev->nl_seq = event->netlink.seq;
+	ev->nl_pid = event->netlink.pid;
+	ev->genl_cmd = event->netlink.genl_cmd;
+	ev->genl_version = event->netlink.genl_version;
+	ev->genl_family_id = event->netlink.genl_family_id;
+	ev->sample_weight = event->sample_weight;
+	ev->interface = BINEXP_NO_NAME;
+	ev->genl_family = BINEXP_NO_NAME;
+}
+
+bool binary_exporter_write_event(struct binary_exporter *exporter,
+                                 const struct nlmon_event *event)
+{
+	struct binexp_record rec = { .type = BINEXP_RECORD_EVENT };
+	struct binexp_event ev;
+	size_t raw_len = 0;
+	
+	if (!exporter || !event)
+		return false;
+	
+	if (exporter->options.include_raw && event->raw_msg && event->raw_msg_len < UINT32_MAX - 64)
+		raw_len = event->raw_msg_len;
+	
+	binexp_event_fill(&ev, event);
+	ev.raw_len = (uint32_t)raw_len;
+	
+	/* Name records go ahead of the event */
+	ev.interface = name_id(exporter, event->interface, sizeof(event->interface));
+	ev.genl_family = name_id(exporter, event->netlink.genl_family_name,
+	                         sizeof(event->netlink.genl_family_name));
+	
+	rec.length = (uint32_t)ALIGN8(sizeof(rec) + sizeof(ev) + raw_len);
+	json_buf_append(&exporter->out, (const char *)&rec, sizeof(rec));
+	json_buf_append(&exporter->out, (const char *)&ev, sizeof(ev));
+	if (raw_len) {
+		json_buf_append(&exporter->out, (const char *)event->raw_msg, raw_len);
+		append_padding(&exporter->out, raw_len);
+	}
+	
+	if (exporter->out.failed) {
+		json_buf_reset(&exporter->out);
+		return false;
+	}
+	
+	exporter->events_written++;
+	
+	if (exporter->out.len >= exporter->options.buffer_size)
+		return write_pending(exporter);
+	
+	return true;
+}
+
+bool binary_exporter_flush(struct binary_exporter *exporter)
+{
+	if (!exporter)
+		return false;
+	
+	return write_pending(exporter);
+}
+
+bool binary_exporter_get_stats(struct binary_exporter *exporter,
+                               uint64_t *events_written,
+                               uint64_t *bytes_written,
+                               uint32_t *names)
+{
+	if (!exporter)
+		return false;
+	
+	if (events_written)
+		*events_written = exporter->events_written;
+	if (bytes_written)
+		*bytes_written = exporter->bytes_written;
+	if (names)
+		*names = exporter->name_count;
+	
+	return true;
+}
+
+struct binary_reader *binary_reader_open(const char *filename)
+{
+	const struct binexp_file_header *header;
+	struct binary_reader *reader;
+	struct stat st;
+	void *map;
+	int fd;
+	
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+	
+	if ((size_t)st.st_size < HEADER_SIZE) {
+		close(fd);
+		errno = EPROTO;
+		return NULL;
+	}
+	
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+	
+	/* Only files with the layout this reader was built with */
+	header = map;
+	if (memcmp(header->magic, BINEXP_MAGIC, sizeof(header->magic)) != 0 ||
+	    header->version != BINEXP_VERSION ||
+	    header->header_size != HEADER_SIZE ||
+	    header->field_count != SCHEMA_FIELDS ||
+	    header->event_size != sizeof(struct binexp_event) ||
+	    memcmp(header + 1, schema, sizeof(schema)) != 0) {
+		munmap(map, st.st_size);
+		errno = EPROTO;
+		return NULL;
+	}
+	
+	reader = calloc(1, sizeof(*reader));
+	if (!reader) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	
+	/* Records are read sequentially */
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	
+	reader->map = map;
+	reader->size = st.st_size;
+	reader->pos = HEADER_SIZE;
+	reader->created_ns = header->created_ns;
+	return reader;
+}
+
+void binary_reader_close(struct binary_reader *reader)
+{
+	if (!reader)
+		return;
+	
+	munmap((void *)reader->map, reader->size);
+	free(reader);
+}
+
+static const char *reader_name(const struct binary_reader *reader, uint16_t id)
+{
+	if (id >= BINEXP_MAX_NAMES || !reader->names[id])
+		return "";
+	return reader->names[id];
+}
+
+bool binary_reader_next(struct binary_reader *reader, struct binary_reader_event *out)
+{
+	while (reader && reader->size - reader->pos >= sizeof(struct binexp_record)) {
+		const struct binexp_record *rec = (const void *)(reader->map + reader->pos);
+		const unsigned char *payload = (const unsigned char *)(rec + 1);
+		size_t payload_len = rec->length - sizeof(*rec);
+		
+		/* Cut short or garbage, nothing after it can be trusted */
+		if (rec->length < sizeof(*rec) || rec->length % 8 ||
+		    rec->length > reader->size - reader->pos)
+			return false;
+		
+		reader->pos += rec->length;
+		
+		if (rec->type == BINEXP_RECORD_NAME && payload_len > sizeof(struct binexp_name)) {
+			const struct binexp_name *entry = (const void *)payload;
+			
+			if (entry->id < BINEXP_MAX_NAMES &&
+			    entry->len < payload_len - sizeof(*entry) && entry->name[entry->len] == '\0')
+				reader->names[entry->id] = entry->name;
+			continue;
+		}
+		
+		if (rec->type != BINEXP_RECORD_EVENT || payload_len < sizeof(struct binexp_event))
+			continue;
+		
+		out->event = (const void *)payload;
+		if (out->event->raw_len > payload_len - sizeof(struct binexp_event))
+			return false;
+		
+		out->interface = reader_name(reader, out->event->interface);
+		out->genl_family = reader_name(reader, out->event->genl_family);
+		out->raw_len = out->event->raw_len;
+		out->raw = out->raw_len ? payload + sizeof(struct binexp_event) : NULL;
+		return true;
+	}
+	
+	return false;
+}
+
+void binary_reader_rewind(struct binary_reader *reader)
+{
+	if (!reader)
+		return;
+	
+	reader->pos = HEADER_SIZE;
+	memset(reader->names, 0, sizeof(reader->names));
+}
+
+uint64_t binary_reader_created(const struct binary_reader *reader)
+{
+	return reader ? reader->created_ns : 0;
+}
@@ -0,0 +1,604 @@
+/* event_aggregator.c - Time-ordered merge of the event streams of many nodes
+ *
+ * Collector workers copy each batch into a chunk, sorted by timestamp,
+ * and queue it on its node. The merge thread keeps the nodes with queued
+ * events in a min-heap keyed by the timestamp of their oldest event, so
+ * each release costs O(log nodes) however many nodes there are.
+ *
+ * The release bound is the lowest latest timestamp of the live nodes with
+ * nothing queued, the nodes an earlier event may still come from. Nodes
+ * only leave that set or raise their timestamp, so a bound computed once
+ * stays safe; it is lowered as nodes run empty, and computed again only
+ * when it holds the oldest event back.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "event_aggregator.h"
+#include "event_processor.h"
+#include "correlation_engine.h"
+#include "alert_manager.h"
+#include "storage_layer.h"
+#include "nlmon_clock.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#define NODE_BUCKETS 1024
+#define RELEASE_BATCH 1024              /* Events handed on per lock round */
+#define IDLE_WAIT_MS 100
+#define MAX_CORRELATIONS 8
+
+struct agg_entry {
+	uint64_t timestamp;
+	const struct event_bus_record *record;
+};
+
+/* One batch of a node, its records follow the entries */
+struct agg_chunk {
+	struct agg_chunk *next;
+	uint64_t arrival_ns;
+	uint32_t count;
+	uint32_t pos;                   /* Next entry to release */
+	uint64_t max_ts;
+	struct agg_entry entries[];
+};
+
+struct agg_node {
+	struct agg_node *next;          /* Hash chain */
+	char name[EVENT_STREAM_NODE_SIZE];
+	struct agg_chunk *head, *tail;
+	uint64_t last_ts;               /* Latest timestamp received */
+	uint64_t last_arrival_ns;
+	size_t heap_pos;                /* SIZE_MAX while nothing is queued */
+};
+
+/* Event released, handed on outside the lock */
+struct agg_out {
+	const char *node;
+	const struct event_bus_record *record;
+};
+
+struct event_aggregator {
+	struct event_aggregator_config config;
+	struct event_collector *collector;
+	uint64_t delay_ns;
+	
+	pthread_mutex_t lock;
+	pthread_cond_t data;            /* Signalled on new batches */
+	pthread_cond_t room;            /* Signalled as the buffer drains */
+	bool draining;                  /* Stopping, release everything */
+	
+	struct agg_node *buckets[NODE_BUCKETS];
+	struct agg_node **nodes;        /* All nodes, for the bound */
+	size_t node_count, node_size;
+	struct agg_node **heap;         /* Nodes with queued events */
+	size_t heap_count;
+	
+	uint64_t bound;                 /* Events up to this are safe to release */
+	uint64_t last_out_ts;
+	unsigned int stalled;           /* Workers waiting for room */
+	
+	pthread_t thread;
+	bool started;
+	
+	/* Statistics, guarded by lock */
+	struct event_aggregator_stats stats;
+	_Atomic uint64_t correlations;
+};
+
+/* Heap of nodes by the timestamp of their oldest queued event */
+
+static uint64_t node_key(const struct agg_node *node)
+{
+	return node->head->entries[node->head->pos].timestamp;
+}
+
+static void heap_set(struct event_aggregator *agg, size_t i, struct agg_node *node)
+{
+	agg->heap[i] = node;
+	node->heap_pos = i;
+}
+
+static void heap_up(struct event_aggregator *agg, size_t i)
+{
+	struct agg_node *node = agg->heap[i];
+	
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+	
+		if (node_key(agg->heap[parent]) <= node_key(node))
+			break;
+		heap_set(agg, i, agg->heap[parent]);
+		i = parent;
+	}
+	heap_set(agg, i, node);
+}
+
+static void heap_down(struct event_aggregator *agg, size_t i)
+{
+	struct agg_node *node = agg->heap[i];
+	
+	for (;;) {
+		size_t child = 2 * i + 1;
+	
+		if (child >= agg->heap_count)
+			break;
+		if (child + 1 < agg->heap_count &&
+		    node_key(agg->heap[child + 1]) < node_key(agg->heap[child]))
+			child++;
+		if (node_key(node) <= node_key(agg->heap[child]))
+			break;
+		heap_set(agg, i, agg->heap[child]);
+		i = child;
+	}
+	heap_set(agg, i, node);
+}
+
+static void heap_pop(struct event_aggregator *agg)
+{
+	agg->heap[0]->heap_pos = SIZE_MAX;
+	if (--agg->heap_count > 0) {
+		heap_set(agg, 0, agg->heap[agg->heap_count]);
+		heap_down(agg, 0);
+	}
+}
+
+/* Nodes */
+
+static struct agg_node *node_get(struct event_aggregator *agg, const char *name)
+{
+	struct agg_node *node;
+	uint32_t hash = 2166136261u;
+	
+	for (const char *p = name; *p; p++)
+		hash = (hash ^ (unsigned char)*p) * 16777619u;
+	hash &= NODE_BUCKETS - 1;
+	
+	for (node = agg->buckets[hash]; node; node = node->next)
+		if (strcmp(node->name, name) == 0)
+			return node;
+	
+	if (agg->node_count == agg->node_size) {
+		size_t size = agg->node_size ? agg->node_size * 2 : 64;
+		struct agg_node **nodes = realloc(agg->nodes, size * sizeof(*nodes));
+		struct agg_node **heap = realloc(agg->heap, size * sizeof(*heap));
+	
+		if (nodes)
+			agg->nodes = nodes;
+		if (heap)
+			agg->heap = heap;
+		if (!nodes || !heap)
+			return NULL;
+		agg->node_size = size;
+	}
+	
+	node = calloc(1, sizeof(*node));
+	if (!node)
+		return NULL;
+	snprintf(node->name, sizeof(node->name), "%s", name);
+	node->heap_pos = SIZE_MAX;
+	node->next = agg->buckets[hash];
+	agg->buckets[hash] = node;
+	agg->nodes[agg->node_count++] = node;
+	agg->stats.nodes++;
+	return node;
+}
+
+/* Whether t, a time of the monotonic clock, is less than the delay ago */
+static bool within_delay(const struct event_aggregator *agg, uint64_t now, uint64_t t)
+{
+	return now < t + agg->delay_ns;
+}
+
+/* Lowest latest timestamp of the live nodes with nothing queued */
+static uint64_t compute_bound(struct event_aggregator *agg, uint64_t now)
+{
+	uint64_t bound = UINT64_MAX;
+	
+	for (size_t i = 0; i < agg->node_count; i++) {
+		struct agg_node *node = agg->nodes[i];
+	
+		if (!node->head && within_delay(agg, now, node->last_arrival_ns) &&
+		    node->last_ts < bound)
+			bound = node->last_ts;
+	}
+	return bound;
+}
+
+/* Collector side */
+
+/* Copy a batch, its entries sorted by timestamp */
+static struct agg_chunk *chunk_build(const struct event_bus_record *const *records, size_t count)
+{
+	struct agg_chunk *chunk;
+	unsigned char *data;
+	size_t bytes = 0;
+	
+	for (size_t i = 0; i < count; i++)
+		bytes += (sizeof(*records[i]) + records[i]->event.raw_len + 7) & ~(size_t)7;
+	
+	chunk = malloc(sizeof(*chunk) + count * sizeof(chunk->entries[0]) + bytes);
+	if (!chunk)
+		return NULL;
+	chunk->next = NULL;
+	chunk->count = (uint32_t)count;
+	chunk->pos = 0;
+	chunk->max_ts = 0;
+	
+	data = (unsigned char *)&chunk->entries[count];
+	for (size_t i = 0; i < count; i++) {
+		size_t len = sizeof(*records[i]) + records[i]->event.raw_len;
+		struct agg_entry entry = {
+			.timestamp = records[i]->event.timestamp,
+			.record = (const struct event_bus_record *)data,
+		};
+		size_t j = i;
+	
+		memcpy(data, records[i], len);
+		data += (len + 7) & ~(size_t)7;
+	
+		/* Insertion sort, a node's events are nearly always in order */
+		while (j > 0 && chunk->entries[j - 1].timestamp > entry.timestamp) {
+			chunk->entries[j] = chunk->entries[j - 1];
+			j--;
+		}
+		chunk->entries[j] = entry;
+		if (entry.timestamp > chunk->max_ts)
+			chunk->max_ts = entry.timestamp;
+	}
+	return chunk;
+}
+
+static void on_batch(const char *name, const struct event_bus_record *const *records,
+                     size_t count, void *ctx)
+{
+	struct event_aggregator *agg = ctx;
+	struct agg_chunk *chunk;
+	struct agg_node *node;
+	
+	chunk = chunk_build(records, count);
+	
+	pthread_mutex_lock(&agg->lock);
+	
+	/* Wait for room, the merge thread releases early for waiters */
+	if (chunk && agg->stats.buffered + count > agg->config.reorder_capacity &&
+	    agg->stats.buffered > 0) {
+		agg->stats.stalls++;
+		agg->stalled++;
+		pthread_cond_signal(&agg->data);
+		while (agg->stats.buffered + count > agg->config.reorder_capacity &&
+		       agg->stats.buffered > 0)
+			pthread_cond_wait(&agg->room, &agg->lock);
+		agg->stalled--;
+	}
+	
+	node = node_get(agg, name);
+	if (!chunk || !node) {
+		agg->stats.dropped += count;
+		pthread_mutex_unlock(&agg->lock);
+		free(chunk);
+		return;
+	}
+	
+	chunk->arrival_ns = nlmon_clock_monotonic_ns();
+	if (node->tail)
+		node->tail->next = chunk;
+	else
+		node->head = chunk;
+	node->tail = chunk;
+	if (chunk->max_ts > node->last_ts)
+		node->last_ts = chunk->max_ts;
+	node->last_arrival_ns = chunk->arrival_ns;
+	
+	if (node->heap_pos == SIZE_MAX) {
+		heap_set(agg, agg->heap_count++, node);
+		heap_up(agg, node->heap_pos);
+	}
+	
+	agg->stats.events_in += count;
+	agg->stats.buffered += count;
+	if (agg->stats.buffered > agg->stats.buffered_max)
+		agg->stats.buffered_max = agg->stats.buffered;
+	
+	pthread_cond_signal(&agg->data);
+	pthread_mutex_unlock(&agg->lock);
+}
+
+/* Merge side */
+
+/* Take the events that may go, retiring drained chunks */
+static size_t release(struct event_aggregator *agg, struct agg_out *out, size_t max,
+                      struct agg_chunk **retired)
+{
+	uint64_t now = nlmon_clock_monotonic_ns();
+	size_t n = 0;
+	
+	while (n < max && agg->heap_count) {
+		struct agg_node *node = agg->heap[0];
+		struct agg_chunk *chunk = node->head;
+		struct agg_entry *entry = &chunk->entries[chunk->pos];
+		bool force = agg->draining || agg->stalled;
+	
+		if (entry->timestamp > agg->bound && !force) {
+			/* Held back, see whether the bound has moved */
+			agg->bound = compute_bound(agg, now);
+			if (entry->timestamp > agg->bound) {
+				if (within_delay(agg, now, chunk->arrival_ns))
+					break;
+				agg->stats.expired++;
+			}
+		}
+	
+		if (entry->timestamp < agg->last_out_ts)
+			agg->stats.late++;
+		else
+			agg->last_out_ts = entry->timestamp;
+		out[n].node = node->name;
+		out[n].record = entry->record;
+		n++;
+		agg->stats.buffered--;
+	
+		if (++chunk->pos == chunk->count) {
+			node->head = chunk->next;
+			if (!node->head)
+				node->tail = NULL;
+			chunk->next = *retired;
+			*retired = chunk;
+		}
+	
+		if (node->head) {
+			heap_down(agg, 0);
+		} else {
+			heap_pop(agg);
+			/* Its next event may be as early as its latest one */
+			if (within_delay(agg, now, node->last_arrival_ns) && node->last_ts < agg->bound)
+				agg->bound = node->last_ts;
+		}
+	}
+	
+	return n;
+}
+
+static void fill_event(struct nlmon_event *event, const char *node,
+                       const struct event_bus_record *rec)
+{
+	const struct binexp_event *ev = &rec->event;
+	
+	memset(event, 0, sizeof(*event));
+	event->timestamp = ev->timestamp;
+	event->sequence = ev->sequence;
+	event->event_type = ev->event_type;
+	event->message_type = ev->message_type;
+	memcpy(event->interface, rec->interface,
+	       strnlen(rec->interface, sizeof(event->interface) - 1));
+	event->user_data = (void *)node;
+	event->netlink.protocol = ev->nl_protocol;
+	event->netlink.msg_type = ev->nl_msg_type;
+	event->netlink.msg_flags = ev->nl_msg_flags;
+	event->netlink.seq = ev->nl_seq;
+	event->netlink.pid = ev->nl_pid;
+	event->netlink.genl_cmd = ev->genl_cmd;
+	event->netlink.genl_version = ev->genl_version;
+	event->netlink.genl_family_id = ev->genl_family_id;
+	event->sample_weight = ev->sample_weight;
+	memcpy(event->netlink.genl_family_name, rec->genl_family,
+	       strnlen(rec->genl_family, sizeof(event->netlink.genl_family_name) - 1));
+	if (ev->raw_len) {
+		event->raw_msg = (struct nlmsghdr *)event_bus_record_raw(rec);
+		event->raw_msg_len = ev->raw_len;
+	}
+}
+
+static void deliver(struct event_aggregator *agg, const struct agg_out *out)
+{
+	const struct event_aggregator_config *config = &agg->config;
+	struct correlation_result results[MAX_CORRELATIONS];
+	struct nlmon_event event;
+	size_t found;
+	
+	fill_event(&event, out->node, out->record);
+
+#ifdef ENABLE_STORAGE
+	if (config->storage)
+		storage_layer_store_event(config->storage, &event, false);
+#endif
+
+	if (config->correlation) {
+		found = correlation_engine_process(config->correlation, &event, results,
+		                                   MAX_CORRELATIONS);
+		if (found) {
+			atomic_fetch_add(&agg->correlations, found);
+			if (config->on_correlation)
+				config->on_correlation(out->node, results, found, config->ctx);
+		}
+	}
+	
+	if (config->alerts)
+		alert_manager_evaluate(config->alerts, &event);
+	
+	if (config->fn)
+		config->fn(out->node, &event, config->ctx);
+}
+
+static void wait_for_data(struct event_aggregator *agg)
+{
+	uint64_t wait_ns = IDLE_WAIT_MS * 1000000ULL;
+	struct timespec ts;
+	
+	/* Until the oldest event expires, if something is held back */
+	if (agg->heap_count) {
+		uint64_t now = nlmon_clock_monotonic_ns();
+		uint64_t expiry = agg->heap[0]->head->arrival_ns + agg->delay_ns;
+	
+		wait_ns = now < expiry ? expiry - now : 0;
+		if (wait_ns < 1000000)
+			wait_ns = 1000000;
+	}
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += wait_ns / 1000000000ULL;
+	ts.tv_nsec += wait_ns % 1000000000ULL;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	pthread_cond_timedwait(&agg->data, &agg->lock, &ts);
+}
+
+static void *merge_thread(void *arg)
+{
+	struct event_aggregator *agg = arg;
+	struct agg_out *out;
+	struct agg_chunk *retired, *next;
+	size_t n;
+	
+	out = malloc(RELEASE_BATCH * sizeof(*out));
+	if (!out)
+		return NULL;
+	
+	for (;;) {
+		retired = NULL;
+	
+		pthread_mutex_lock(&agg->lock);
+		for (;;) {
+			n = release(agg, out, RELEASE_BATCH, &retired);
+			if (n || (agg->draining && !agg->heap_count))
+				break;
+			wait_for_data(agg);
+			if (!agg->heap_count && agg->config.alerts) {
+				/* Digests become due while no events come */
+				pthread_mutex_unlock(&agg->lock);
+				alert_manager_flush(agg->config.alerts, false);
+				pthread_mutex_lock(&agg->lock);
+			}
+		}
+		agg->stats.events_out += n;
+		pthread_cond_broadcast(&agg->room);
+		pthread_mutex_unlock(&agg->lock);
+	
+		if (!n)
+			break;
+	
+		for (size_t i = 0; i < n; i++)
+			deliver(agg, &out[i]);
+	
+		for (; retired; retired = next) {
+			next = retired->next;
+			free(retired);
+		}
+	}
+	
+	free(out);
+	return NULL;
+}
+
+struct event_aggregator *event_aggregator_create(const struct event_aggregator_config *config)
+{
+	struct event_aggregator *agg;
+	struct event_collector_config collector;
+	pthread_condattr_t attr;
+	long cpus;
+	
+	if (!config)
+		return NULL;
+	
+	agg = calloc(1, sizeof(*agg));
+	if (!agg)
+		return NULL;
+	
+	agg->config = *config;
+	if (!agg->config.reorder_delay_ms)
+		agg->config.reorder_delay_ms = EVENT_AGGREGATOR_DELAY_MS;
+	if (!agg->config.reorder_capacity)
+		agg->config.reorder_capacity = EVENT_AGGREGATOR_CAPACITY;
+	agg->delay_ns = agg->config.reorder_delay_ms * 1000000ULL;
+	agg->bound = 0;
+	
+	pthread_mutex_init(&agg->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&agg->data, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_cond_init(&agg->room, NULL);
+	
+	if (pthread_create(&agg->thread, NULL, merge_thread, agg) != 0)
+		goto err;
+	agg->started = true;
+	
+	collector = config->collector;
+	if (!collector.workers) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		collector.workers = cpus > 0 ? (unsigned int)cpus : 1;
+	}
+	collector.fn = NULL;
+	collector.batch_fn = on_batch;
+	collector.ctx = agg;
+	agg->collector = event_collector_create(&collector);
+	if (!agg->collector)
+		goto err;
+	
+	return agg;
+
+err:
+	event_aggregator_destroy(agg);
+	return NULL;
+}
+
+void event_aggregator_destroy(struct event_aggregator *agg)
+{
+	if (!agg)
+		return;
+	
+	/* No more batches, then release the rest in order */
+	event_collector_destroy(agg->collector);
+	
+	pthread_mutex_lock(&agg->lock);
+	agg->draining = true;
+	pthread_cond_signal(&agg->data);
+	pthread_mutex_unlock(&agg->lock);
+	if (agg->started)
+		pthread_join(agg->thread, NULL);
+	
+	for (size_t i = 0; i < agg->node_count; i++) {
+		struct agg_chunk *chunk, *next;
+	
+		for (chunk = agg->nodes[i]->head; chunk; chunk = next) {
+			next = chunk->next;
+			free(chunk);
+		}
+		free(agg->nodes[i]);
+	}
+	free(agg->nodes);
+	free(agg->heap);
+	
+	pthread_cond_destroy(&agg->room);
+	pthread_cond_destroy(&agg->data);
+	pthread_mutex_destroy(&agg->lock);
+	free(agg);
+}
+
+uint16_t event_aggregator_port(const struct event_aggregator *agg)
+{
+	return agg ? event_collector_port(agg->collector) : 0;
+}
+
+void event_aggregator_get_stats(struct event_aggregator *agg,
+                                struct event_aggregator_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (!agg)
+		return;
+	
+	pthread_mutex_lock(&agg->lock);
+	*stats = agg->stats;
+	pthread_mutex_unlock(&agg->lock);
+	stats->correlations = atomic_load(&agg->correlations);
+	event_collector_get_stats(agg->collector, &stats->collector);
+}
@@ -0,0 +1,225 @@
+/* event_bus.c - Shared memory event bus, publisher side */
+
+#include "event_bus.h"
+#include "event_processor.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define ALIGN8(x) (((x) + 7) & ~(size_t)7)
+#define HEADER_SIZE ALIGN8(sizeof(struct event_bus_header))
+
+_Static_assert(sizeof(struct event_bus_slot) % 8 == 0, "slots must stay aligned");
+
+struct event_bus {
+	char *name;
+	struct event_bus_header *hdr;
+	unsigned char *slots;
+	size_t map_size;
+	uint64_t mask;
+	size_t raw_max;                 /* Raw bytes a slot holds */
+	bool include_raw;
+	
+	/* Serializes publishers, the ring has a single writer */
+	pthread_mutex_t lock;
+	
+	/* Statistics, guarded by lock */
+	uint64_t truncated;
+	uint64_t wakeups;
+};
+
+static void copy_name(char *dst, const char *src, size_t size)
+{
+	size_t len = strnlen(src, size);
+	
+	if (len >= BINEXP_NAME_SIZE)
+		len = BINEXP_NAME_SIZE - 1;
+	memcpy(dst, src, len);
+	memset(dst + len, 0, BINEXP_NAME_SIZE - len);
+}
+
+struct event_bus *event_bus_create(const char *name, const struct event_bus_options *options)
+{
+	struct event_bus_options opts = {0};
+	struct event_bus *bus;
+	struct timespec ts;
+	uint64_t slots = 1;
+	void *map;
+	int fd, err;
+	
+	if (!name || name[0] != '/') {
+		errno = EINVAL;
+		return NULL;
+	}
+	
+	if (options)
+		opts = *options;
+	if (opts.slots == 0)
+		opts.slots = EVENT_BUS_DEFAULT_SLOTS;
+	if (opts.slot_size == 0)
+		opts.slot_size = EVENT_BUS_DEFAULT_SLOT_SIZE;
+	if (opts.mode == 0)
+		opts.mode = 0600;
+	opts.slot_size = ALIGN8(opts.slot_size);
+	
+	if (opts.slot_size < sizeof(struct event_bus_slot) || opts.slots > (1u << 24)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	while (slots < opts.slots)
+		slots <<= 1;
+	
+	bus = calloc(1, sizeof(*bus));
+	if (!bus)
+		return NULL;
+	
+	bus->name = strdup(name);
+	if (!bus->name)
+		goto err_free;
+	
+	bus->mask = slots - 1;
+	bus->raw_max = opts.slot_size - sizeof(struct event_bus_slot);
+	bus->include_raw = opts.include_raw;
+	bus->map_size = HEADER_SIZE + slots * opts.slot_size;
+	pthread_mutex_init(&bus->lock, NULL);
+	
+	/* A fresh segment, readers of a stale one keep their mapping */
+	shm_unlink(name);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, opts.mode);
+	if (fd < 0)
+		goto err_name;
+	
+	/* shm_open() applies the umask */
+	if (fchmod(fd, opts.mode) < 0 || ftruncate(fd, (off_t)bus->map_size) < 0)
+		goto err_unlink;
+	
+	map = mmap(NULL, bus->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto err_unlink;
+	close(fd);
+	
+	bus->hdr = map;
+	bus->slots = (unsigned char *)map + HEADER_SIZE;
+	
+	clock_gettime(CLOCK_REALTIME, &ts);
+	bus->hdr->version = EVENT_BUS_VERSION;
+	bus->hdr->header_size = HEADER_SIZE;
+	bus->hdr->slot_count = (uint32_t)slots;
+	bus->hdr->slot_size = opts.slot_size;
+	bus->hdr->event_size = sizeof(struct binexp_event);
+	bus->hdr->publisher_pid = (uint32_t)getpid();
+	bus->hdr->created_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+	
+	/* Readers check the magic last */
+	atomic_thread_fence(memory_order_release);
+	bus->hdr->magic = EVENT_BUS_MAGIC;
+	
+	return bus;
+
+err_unlink:
+	err = errno;
+	close(fd);
+	shm_unlink(name);
+	errno = err;
+err_name:
+	err = errno;
+	pthread_mutex_destroy(&bus->lock);
+	free(bus->name);
+	errno = err;
+err_free:
+	err = errno;
+	free(bus);
+	errno = err;
+	return NULL;
+}
+
+/* Wake sleeping readers, after head or closed changed */
+static void bus_notify(struct event_bus *bus)
+{
+	atomic_fetch_add(&bus->hdr->futex, 1);
+	if (atomic_load(&bus->hdr->waiters) == 0)
+		return;
+	
+	syscall(SYS_futex, &bus->hdr->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	bus->wakeups++;
+}
+
+void event_bus_destroy(struct event_bus *bus)
+{
+	if (!bus)
+		return;
+	
+	pthread_mutex_lock(&bus->lock);
+	atomic_store_explicit(&bus->hdr->closed, 1, memory_order_release);
+	bus_notify(bus);
+	pthread_mutex_unlock(&bus->lock);
+	
+	munmap(bus->hdr, bus->map_size);
+	shm_unlink(bus->name);
+	pthread_mutex_destroy(&bus->lock);
+	free(bus->name);
+	free(bus);
+}
+
+bool event_bus_publish(struct event_bus *bus, const struct nlmon_event *event)
+{
+	struct event_bus_slot *slot;
+	size_t raw_len = 0;
+	uint64_t pos;
+	
+	if (!bus || !event)
+		return false;
+	
+	pthread_mutex_lock(&bus->lock);
+	
+	pos = atomic_load_explicit(&bus->hdr->head, memory_order_relaxed);
+	slot = (struct event_bus_slot *)(bus->slots + (pos & bus->mask) * bus->hdr->slot_size);
+	
+	/* Readers still on the previous record of this slot see it go */
+	atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	
+	binexp_event_fill(&slot->record.event, event);
+	copy_name(slot->record.interface, event->interface, sizeof(event->interface));
+	copy_name(slot->record.genl_family, event->netlink.genl_family_name,
+	          sizeof(event->netlink.genl_family_name));
+	
+	if (bus->include_raw && event->raw_msg && event->raw_msg_len > 0) {
+		raw_len = event->raw_msg_len;
+		if (raw_len > bus->raw_max) {
+			raw_len = bus->raw_max;
+			bus->truncated++;
+		}
+		memcpy(slot + 1, event->raw_msg, raw_len);
+	}
+	slot->record.event.raw_len = (uint32_t)raw_len;
+	
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+	atomic_store_explicit(&bus->hdr->head, pos + 1, memory_order_release);
+	bus_notify(bus);
+	
+	pthread_mutex_unlock(&bus->lock);
+	return true;
+}
+
+void event_bus_get_stats(struct event_bus *bus, struct event_bus_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (!bus)
+		return;
+	
+	pthread_mutex_lock(&bus->lock);
+	stats->published = atomic_load_explicit(&bus->hdr->head, memory_order_relaxed);
+	stats->truncated = bus->truncated;
+	stats->wakeups = bus->wakeups;
+	pthread_mutex_unlock(&bus->lock);
+}
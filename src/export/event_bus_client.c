@@ -0,0 +1,236 @@
+/* event_bus_client.c - Shared memory event bus, reader side
+ *
+ * Built on its own into libnlmon-bus.a for local consumers.
+ */
+
+#include "event_bus.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+struct event_bus_reader {
+	struct event_bus_header *hdr;
+	const unsigned char *slots;
+	size_t map_size;
+	uint64_t mask;
+	uint32_t slot_size;
+	
+	uint64_t cursor;                /* Position of the next record */
+	uint64_t peeked;                /* Position + 1 of the peeked record, 0 if none */
+	uint64_t lost;
+};
+
+static const struct event_bus_slot *slot_at(const struct event_bus_reader *reader, uint64_t pos)
+{
+	return (const struct event_bus_slot *)(reader->slots + (pos & reader->mask) * reader->slot_size);
+}
+
+struct event_bus_reader *event_bus_reader_open(const char *name, unsigned int flags)
+{
+	const struct event_bus_header *hdr;
+	struct event_bus_reader *reader;
+	struct stat st;
+	uint64_t head;
+	void *map;
+	int fd, err;
+	
+	/* Read-write, readers register on the futex */
+	fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+	if (fd < 0)
+		return NULL;
+	
+	if (fstat(fd, &st) < 0) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+	if ((size_t)st.st_size < sizeof(struct event_bus_header)) {
+		close(fd);
+		errno = EPROTO;
+		return NULL;
+	}
+	
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	err = errno;
+	close(fd);
+	if (map == MAP_FAILED) {
+		errno = err;
+		return NULL;
+	}
+	
+	hdr = map;
+	if (hdr->magic != EVENT_BUS_MAGIC || hdr->version != EVENT_BUS_VERSION ||
+	    hdr->event_size != sizeof(struct binexp_event) ||
+	    hdr->slot_size < sizeof(struct event_bus_slot) || hdr->slot_size % 8 ||
+	    !hdr->slot_count || hdr->slot_count & (hdr->slot_count - 1) ||
+	    hdr->header_size + (uint64_t)hdr->slot_count * hdr->slot_size > (uint64_t)st.st_size) {
+		munmap(map, st.st_size);
+		errno = EPROTO;
+		return NULL;
+	}
+	atomic_thread_fence(memory_order_acquire);
+	
+	reader = calloc(1, sizeof(*reader));
+	if (!reader) {
+		munmap(map, st.st_size);
+		errno = ENOMEM;
+		return NULL;
+	}
+	
+	reader->hdr = map;
+	reader->slots = (const unsigned char *)map + hdr->header_size;
+	reader->map_size = st.st_size;
+	reader->mask = hdr->slot_count - 1;
+	reader->slot_size = hdr->slot_size;
+	
+	head = atomic_load_explicit(&reader->hdr->head, memory_order_acquire);
+	reader->cursor = head;
+	if (flags & EVENT_BUS_FROM_OLDEST)
+		reader->cursor = head > hdr->slot_count ? head - hdr->slot_count : 0;
+	
+	return reader;
+}
+
+void event_bus_reader_close(struct event_bus_reader *reader)
+{
+	if (!reader)
+		return;
+	
+	munmap(reader->hdr, reader->map_size);
+	free(reader);
+}
+
+int event_bus_reader_peek(struct event_bus_reader *reader, const struct event_bus_record **out)
+{
+	const struct event_bus_slot *slot;
+	uint64_t head, oldest;
+	
+	for (;;) {
+		head = atomic_load_explicit(&reader->hdr->head, memory_order_acquire);
+		if (reader->cursor >= head) {
+			reader->peeked = 0;
+			if (atomic_load_explicit(&reader->hdr->closed, memory_order_acquire) &&
+			    reader->cursor == atomic_load_explicit(&reader->hdr->head, memory_order_acquire))
+				return -EPIPE;
+			return -EAGAIN;
+		}
+	
+		/* Fell a ring behind, skip what was overwritten */
+		oldest = head > reader->mask + 1 ? head - reader->mask - 1 : 0;
+		if (reader->cursor < oldest) {
+			reader->lost += oldest - reader->cursor;
+			reader->cursor = oldest;
+		}
+	
+		slot = slot_at(reader, reader->cursor);
+		if (atomic_load_explicit(&slot->seq, memory_order_acquire) == reader->cursor + 1)
+			break;
+	
+		/* Overwritten since head was read */
+		reader->lost++;
+		reader->cursor++;
+	}
+	
+	reader->peeked = reader->cursor + 1;
+	*out = &slot->record;
+	return 0;
+}
+
+bool event_bus_reader_release(struct event_bus_reader *reader)
+{
+	const struct event_bus_slot *slot;
+	bool intact;
+	
+	if (!reader->peeked)
+		return false;
+	
+	/* What was read of the record happened before this check */
+	atomic_thread_fence(memory_order_acquire);
+	slot = slot_at(reader, reader->peeked - 1);
+	intact = atomic_load_explicit(&slot->seq, memory_order_relaxed) == reader->peeked;
+	
+	if (!intact)
+		reader->lost++;
+	reader->cursor = reader->peeked;
+	reader->peeked = 0;
+	return intact;
+}
+
+int event_bus_reader_read(struct event_bus_reader *reader, void *buf, size_t len)
+{
+	const struct event_bus_record *record;
+	size_t size;
+	int ret;
+	
+	for (;;) {
+		ret = event_bus_reader_peek(reader, &record);
+		if (ret < 0)
+			return ret;
+	
+		/* raw_len of a record being overwritten can be anything */
+		size = sizeof(*record) + record->event.raw_len;
+		if (size > sizeof(*record) + reader->slot_size - sizeof(struct event_bus_slot))
+			size = sizeof(*record) + reader->slot_size - sizeof(struct event_bus_slot);
+		if (size > len)
+			size = len;
+		memcpy(buf, record, size);
+	
+		if (event_bus_reader_release(reader))
+			return (int)size;
+	}
+}
+
+int event_bus_reader_wait(struct event_bus_reader *reader, int timeout_ms)
+{
+	struct event_bus_header *hdr = reader->hdr;
+	struct timespec ts, *timeout = NULL;
+	uint32_t seen;
+	int ret = 0;
+	
+	if (timeout_ms >= 0) {
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+		timeout = &ts;
+	}
+	
+	/* A publish after this read changes the futex, so the wait returns at once */
+	seen = atomic_load(&hdr->futex);
+	if (reader->cursor < atomic_load(&hdr->head))
+		return 0;
+	if (atomic_load(&hdr->closed))
+		return -EPIPE;
+	
+	atomic_fetch_add(&hdr->waiters, 1);
+	if (syscall(SYS_futex, &hdr->futex, FUTEX_WAIT, seen, timeout, NULL, 0) < 0 &&
+	    errno != EAGAIN)
+		ret = errno == ETIMEDOUT ? -ETIMEDOUT : -errno;
+	atomic_fetch_sub(&hdr->waiters, 1);
+	
+	if (reader->cursor < atomic_load(&hdr->head))
+		return 0;
+	if (atomic_load(&hdr->closed))
+		return -EPIPE;
+	return ret;
+}
+
+uint64_t event_bus_reader_lost(const struct event_bus_reader *reader)
+{
+	return reader->lost;
+}
+
+uint64_t event_bus_reader_backlog(const struct event_bus_reader *reader)
+{
+	uint64_t head = atomic_load_explicit(&reader->hdr->head, memory_order_acquire);
+	
+	if (reader->cursor >= head)
+		return 0;
+	return head - reader->cursor > reader->mask + 1 ? reader->mask + 1 : head - reader->cursor;
+}
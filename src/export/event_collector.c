@@ -0,0 +1,737 @@
+/* event_collector.c - Batched, compressed event streaming, collector side
+ *
+ * Connections are spread over worker threads, each with an epoll set of
+ * its own that also holds the listening socket (EPOLLEXCLUSIVE, so one
+ * worker takes each new connection). Batches of different nodes are thus
+ * decoded in parallel. A batch is checked against its crc, converted to
+ * host byte order if the node differs, and its events are handed to the
+ * callback before the batch is acknowledged.
+ *
+ * Each node's last batch sequence is kept across its connections, so
+ * batches an exporter sends again after a reconnect are acknowledged
+ * without being handed on twice. The node lock is held while a batch is
+ * handed on, so two connections of one node cannot interleave.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "event_stream.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <byteswap.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <zlib.h>
+
+#ifdef ENABLE_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+#define NODE_BUCKETS 1024
+#define POLL_INTERVAL_MS 100
+#define MAX_EVENTS 256                  /* epoll events handled per wakeup */
+
+struct collector_node {
+	struct collector_node *next;
+	char name[EVENT_STREAM_NODE_SIZE];
+	pthread_mutex_t lock;           /* Held while a batch is handed on */
+	uint64_t last_seq;              /* Last batch handed on */
+};
+
+struct collector_worker;
+
+struct collector_client {
+	struct collector_client *next, *prev;
+	struct collector_worker *worker;
+	int fd;
+#ifdef ENABLE_TLS
+	SSL *ssl;
+#endif
+	struct collector_node *node;    /* NULL until the hello */
+	bool swap;                      /* Records in the other byte order */
+	
+	/* Frame being read */
+	struct event_stream_frame frame;
+	size_t frame_len;
+	unsigned char *payload;
+	size_t payload_len;
+	size_t payload_size;
+};
+
+/* Serving thread */
+struct collector_worker {
+	struct event_collector *collector;
+	pthread_t thread;
+	bool started;
+	int epoll_fd;
+	struct collector_client *clients;
+	
+	/* Decoded batch and its records */
+	unsigned char *raw;
+	size_t raw_size;
+	const struct event_bus_record **records;
+	size_t records_size;
+};
+
+struct event_collector {
+	struct event_collector_config config;
+	int listen_fd;
+	uint16_t port;
+#ifdef ENABLE_TLS
+	SSL_CTX *ssl_ctx;
+#endif
+
+	struct collector_worker *workers;
+	atomic_uint nclients;
+	atomic_bool running;
+	
+	pthread_mutex_t nodes_lock;
+	struct collector_node *nodes[NODE_BUCKETS];
+	
+	/* Statistics, guarded by lock */
+	pthread_mutex_t lock;
+	struct event_collector_stats stats;
+};
+
+/* epoll tag of the listening socket */
+static const char listen_tag;
+#define LISTEN_TAG ((void *)&listen_tag)
+
+static void frame_encode(struct event_stream_frame *out, uint16_t type, uint64_t seq)
+{
+	memset(out, 0, sizeof(*out));
+	out->magic = htole32(EVENT_STREAM_MAGIC);
+	out->type = htole16(type);
+	out->seq = htole64(seq);
+}
+
+static void frame_decode(struct event_stream_frame *frame)
+{
+	frame->magic = le32toh(frame->magic);
+	frame->type = le16toh(frame->type);
+	frame->codec = le16toh(frame->codec);
+	frame->seq = le64toh(frame->seq);
+	frame->len = le32toh(frame->len);
+	frame->raw_len = le32toh(frame->raw_len);
+	frame->count = le32toh(frame->count);
+	frame->crc = le32toh(frame->crc);
+}
+
+static void count_stat(struct event_collector *collector, uint64_t *stat, uint64_t n)
+{
+	pthread_mutex_lock(&collector->lock);
+	*stat += n;
+	pthread_mutex_unlock(&collector->lock);
+}
+
+static struct collector_node *node_get(struct event_collector *collector, const char *name)
+{
+	struct collector_node *node;
+	uint32_t hash = 2166136261u;
+	
+	for (const char *p = name; *p; p++)
+		hash = (hash ^ (unsigned char)*p) * 16777619u;
+	hash &= NODE_BUCKETS - 1;
+	
+	pthread_mutex_lock(&collector->nodes_lock);
+	for (node = collector->nodes[hash]; node; node = node->next)
+		if (strcmp(node->name, name) == 0)
+			goto out;
+	
+	node = calloc(1, sizeof(*node));
+	if (!node)
+		goto out;
+	memcpy(node->name, name, sizeof(node->name));
+	pthread_mutex_init(&node->lock, NULL);
+	node->next = collector->nodes[hash];
+	collector->nodes[hash] = node;
+	
+	pthread_mutex_lock(&collector->lock);
+	collector->stats.nodes++;
+	pthread_mutex_unlock(&collector->lock);
+out:
+	pthread_mutex_unlock(&collector->nodes_lock);
+	return node;
+}
+
+/* Connections */
+
+static void client_close(struct collector_client *client)
+{
+	struct collector_worker *worker = client->worker;
+	struct event_collector *collector = worker->collector;
+	
+	epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+#ifdef ENABLE_TLS
+	if (client->ssl) {
+		SSL_shutdown(client->ssl);
+		SSL_free(client->ssl);
+	}
+#endif
+	close(client->fd);
+	
+	if (client->prev)
+		client->prev->next = client->next;
+	else
+		worker->clients = client->next;
+	if (client->next)
+		client->next->prev = client->prev;
+	free(client->payload);
+	free(client);
+	
+	atomic_fetch_sub(&collector->nclients, 1);
+}
+
+static bool client_send(struct collector_client *client, uint16_t type, uint64_t seq)
+{
+	struct event_stream_frame frame;
+	ssize_t n;
+	
+	frame_encode(&frame, type, seq);
+#ifdef ENABLE_TLS
+	if (client->ssl)
+		return SSL_write(client->ssl, &frame, sizeof(frame)) == (int)sizeof(frame);
+#endif
+	do {
+		n = send(client->fd, &frame, sizeof(frame), MSG_NOSIGNAL | MSG_DONTWAIT);
+	} while (n < 0 && errno == EINTR);
+	return n == (ssize_t)sizeof(frame);
+}
+
+/* Read what is available, 0 once the socket is drained, -1 on EOF or error */
+static ssize_t client_read(struct collector_client *client, void *buf, size_t len)
+{
+	ssize_t n;
+
+#ifdef ENABLE_TLS
+	if (client->ssl) {
+		n = SSL_read(client->ssl, buf, (int)len);
+		if (n > 0)
+			return n;
+		return SSL_get_error(client->ssl, (int)n) == SSL_ERROR_WANT_READ ? 0 : -1;
+	}
+#endif
+
+	n = recv(client->fd, buf, len, MSG_DONTWAIT);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	return n > 0 ? n : -1;
+}
+
+static void accept_clients(struct collector_worker *worker)
+{
+	struct event_collector *collector = worker->collector;
+	struct collector_client *client;
+	struct epoll_event ev;
+	int fd;
+	
+	for (;;) {
+		fd = accept4(collector->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0)
+			return;
+	
+		if (atomic_fetch_add(&collector->nclients, 1) >= collector->config.max_clients) {
+			atomic_fetch_sub(&collector->nclients, 1);
+			close(fd);
+			continue;
+		}
+	
+		client = calloc(1, sizeof(*client));
+		if (!client) {
+			atomic_fetch_sub(&collector->nclients, 1);
+			close(fd);
+			continue;
+		}
+		client->worker = worker;
+		client->fd = fd;
+
+#ifdef ENABLE_TLS
+		if (collector->ssl_ctx) {
+			struct timeval tv = { .tv_sec = 5 };
+	
+			/* Handshake blocking, bounded by the timeout */
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+			client->ssl = SSL_new(collector->ssl_ctx);
+			if (!client->ssl || (SSL_set_fd(client->ssl, fd), SSL_accept(client->ssl) != 1)) {
+				SSL_free(client->ssl);
+				free(client);
+				atomic_fetch_sub(&collector->nclients, 1);
+				close(fd);
+				continue;
+			}
+		}
+#endif
+
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.ptr = client;
+		if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+#ifdef ENABLE_TLS
+			SSL_free(client->ssl);
+#endif
+			free(client);
+			atomic_fetch_sub(&collector->nclients, 1);
+			close(fd);
+			continue;
+		}
+	
+		client->next = worker->clients;
+		if (worker->clients)
+			worker->clients->prev = client;
+		worker->clients = client;
+	
+		count_stat(collector, &collector->stats.connections, 1);
+	}
+}
+
+/* Frames */
+
+static void swap_record(struct binexp_record *rec, struct event_bus_record *body)
+{
+	struct binexp_event *ev = &body->event;
+	
+	rec->length = bswap_32(rec->length);
+	rec->type = bswap_16(rec->type);
+	ev->timestamp = bswap_64(ev->timestamp);
+	ev->sequence = bswap_64(ev->sequence);
+	ev->event_type = bswap_32(ev->event_type);
+	ev->message_type = bswap_16(ev->message_type);
+	ev->interface = bswap_16(ev->interface);
+	ev->nl_protocol = (int32_t)bswap_32((uint32_t)ev->nl_protocol);
+	ev->nl_msg_type = bswap_16(ev->nl_msg_type);
+	ev->nl_msg_flags = bswap_16(ev->nl_msg_flags);
+	ev->nl_seq = bswap_32(ev->nl_seq);
+	ev->nl_pid = bswap_32(ev->nl_pid);
+	ev->genl_family_id = bswap_16(ev->genl_family_id);
+	ev->genl_family = bswap_16(ev->genl_family);
+	ev->raw_len = bswap_32(ev->raw_len);
+	ev->sample_weight = bswap_32(ev->sample_weight);
+}
+
+static bool handle_hello(struct event_collector *collector, struct collector_client *client)
+{
+	struct event_stream_hello hello;
+	bool big_endian = __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+	uint64_t last_seq;
+	
+	if (client->node || client->frame.len != sizeof(hello))
+		return false;
+	
+	memcpy(&hello, client->payload, sizeof(hello));
+	hello.node[sizeof(hello.node) - 1] = '\0';
+	if (le16toh(hello.version) != EVENT_STREAM_VERSION ||
+	    le32toh(hello.event_size) != sizeof(struct binexp_event) || !hello.node[0])
+		return false;
+	
+	client->node = node_get(collector, hello.node);
+	if (!client->node)
+		return false;
+	client->swap = !!hello.big_endian != big_endian;
+	
+	pthread_mutex_lock(&client->node->lock);
+	last_seq = client->node->last_seq;
+	pthread_mutex_unlock(&client->node->lock);
+	return client_send(client, EVENT_STREAM_WELCOME, last_seq);
+}
+
+/* Decode a batch into the worker's buffer, NULL if it is malformed */
+static unsigned char *decode_batch(struct collector_worker *worker, struct collector_client *client)
+{
+	const struct event_stream_frame *frame = &client->frame;
+	uLongf len = frame->raw_len;
+	
+	if (frame->raw_len > EVENT_STREAM_MAX_FRAME)
+		return NULL;
+	
+	if (frame->raw_len > worker->raw_size) {
+		unsigned char *raw = realloc(worker->raw, frame->raw_len);
+		if (!raw)
+			return NULL;
+		worker->raw = raw;
+		worker->raw_size = frame->raw_len;
+	}
+	
+	switch (frame->codec) {
+	case EVENT_STREAM_CODEC_NONE:
+		if (frame->len != frame->raw_len)
+			return NULL;
+		memcpy(worker->raw, client->payload, frame->len);
+		break;
+	case EVENT_STREAM_CODEC_DEFLATE:
+		if (uncompress(worker->raw, &len, client->payload, frame->len) != Z_OK ||
+		    len != frame->raw_len)
+			return NULL;
+		break;
+	default:
+		return NULL;
+	}
+	
+	if ((uint32_t)crc32(0, worker->raw, frame->raw_len) != frame->crc)
+		return NULL;
+	return worker->raw;
+}
+
+/* Check and convert every record, filling worker->records */
+static bool parse_batch(struct collector_worker *worker, struct collector_client *client,
+                        unsigned char *raw)
+{
+	const struct event_stream_frame *frame = &client->frame;
+	size_t pos = 0, count = 0;
+	
+	if (frame->count > worker->records_size) {
+		const struct event_bus_record **records;
+	
+		records = realloc(worker->records, frame->count * sizeof(*records));
+		if (!records)
+			return false;
+		worker->records = records;
+		worker->records_size = frame->count;
+	}
+	
+	while (pos < frame->raw_len) {
+		struct binexp_record *rec = (struct binexp_record *)(raw + pos);
+		struct event_bus_record *body = (struct event_bus_record *)(rec + 1);
+	
+		if (frame->raw_len - pos < sizeof(*rec) + sizeof(*body) || count == frame->count)
+			return false;
+		if (client->swap)
+			swap_record(rec, body);
+		if (rec->type != BINEXP_RECORD_EVENT || rec->length % 8 ||
+		    rec->length < sizeof(*rec) + sizeof(*body) + body->event.raw_len ||
+		    rec->length > frame->raw_len - pos)
+			return false;
+		body->interface[sizeof(body->interface) - 1] = '\0';
+		body->genl_family[sizeof(body->genl_family) - 1] = '\0';
+		worker->records[count++] = body;
+		pos += rec->length;
+	}
+	
+	return count == frame->count;
+}
+
+static bool handle_batch(struct collector_worker *worker, struct collector_client *client)
+{
+	struct event_collector *collector = worker->collector;
+	const struct event_stream_frame *frame = &client->frame;
+	struct collector_node *node = client->node;
+	unsigned char *raw;
+	bool duplicate;
+	
+	if (!node)
+		return false;
+	
+	/* Decode outside the node lock, seq is checked again under it */
+	pthread_mutex_lock(&node->lock);
+	duplicate = frame->seq <= node->last_seq;
+	pthread_mutex_unlock(&node->lock);
+	
+	if (!duplicate) {
+		raw = decode_batch(worker, client);
+		if (!raw || !parse_batch(worker, client, raw))
+			return false;
+	
+		pthread_mutex_lock(&node->lock);
+		duplicate = frame->seq <= node->last_seq;
+		if (!duplicate) {
+			if (collector->config.batch_fn) {
+				collector->config.batch_fn(node->name, worker->records, frame->count,
+				                           collector->config.ctx);
+			} else {
+				for (uint32_t i = 0; i < frame->count; i++)
+					collector->config.fn(node->name, worker->records[i],
+					                     collector->config.ctx);
+			}
+			node->last_seq = frame->seq;
+		}
+		pthread_mutex_unlock(&node->lock);
+	}
+	
+	pthread_mutex_lock(&collector->lock);
+	if (duplicate) {
+		/* Already handed on, over another connection */
+		collector->stats.duplicates++;
+	} else {
+		collector->stats.batches++;
+		collector->stats.events += frame->count;
+		collector->stats.bytes_raw += frame->raw_len;
+	}
+	pthread_mutex_unlock(&collector->lock);
+	
+	return client_send(client, EVENT_STREAM_ACK, frame->seq);
+}
+
+/* Read frames until the socket is drained, false to close the client */
+static bool client_input(struct collector_worker *worker, struct collector_client *client)
+{
+	struct event_collector *collector = worker->collector;
+	ssize_t n;
+	bool ok;
+	
+	for (;;) {
+		if (client->frame_len < sizeof(client->frame)) {
+			n = client_read(client, (unsigned char *)&client->frame + client->frame_len,
+			                sizeof(client->frame) - client->frame_len);
+			if (n <= 0)
+				return n == 0;
+			client->frame_len += (size_t)n;
+			if (client->frame_len < sizeof(client->frame))
+				continue;
+	
+			frame_decode(&client->frame);
+			if (client->frame.magic != EVENT_STREAM_MAGIC ||
+			    client->frame.len > EVENT_STREAM_MAX_FRAME)
+				return false;
+	
+			if (client->frame.len > client->payload_size) {
+				unsigned char *payload = realloc(client->payload, client->frame.len);
+				if (!payload)
+					return false;
+				client->payload = payload;
+				client->payload_size = client->frame.len;
+			}
+			client->payload_len = 0;
+		}
+	
+		if (client->payload_len < client->frame.len) {
+			n = client_read(client, client->payload + client->payload_len,
+			                client->frame.len - client->payload_len);
+			if (n <= 0)
+				return n == 0;
+			client->payload_len += (size_t)n;
+			if (client->payload_len < client->frame.len)
+				continue;
+		}
+	
+		count_stat(collector, &collector->stats.bytes_in, sizeof(client->frame) + client->frame.len);
+	
+		switch (client->frame.type) {
+		case EVENT_STREAM_HELLO:
+			ok = handle_hello(collector, client);
+			break;
+		case EVENT_STREAM_BATCH:
+			ok = handle_batch(worker, client);
+			break;
+		default:
+			ok = false;
+			break;
+		}
+		if (!ok)
+			return false;
+	
+		client->frame_len = 0;
+		client->payload_len = 0;
+	}
+}
+
+static void *worker_thread(void *arg)
+{
+	struct collector_worker *worker = arg;
+	struct event_collector *collector = worker->collector;
+	struct epoll_event events[MAX_EVENTS];
+	int n;
+	
+	while (atomic_load(&collector->running)) {
+		n = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, POLL_INTERVAL_MS);
+	
+		for (int i = 0; i < n; i++) {
+			struct collector_client *client = events[i].data.ptr;
+	
+			if (events[i].data.ptr == LISTEN_TAG) {
+				accept_clients(worker);
+				continue;
+			}
+	
+			if (!client_input(worker, client)) {
+				/* An orderly end of stream falls between frames */
+				if (client->frame_len != 0 || !(events[i].events & (EPOLLIN | EPOLLRDHUP)))
+					count_stat(collector, &collector->stats.errors, 1);
+				client_close(client);
+			}
+		}
+	}
+	
+	while (worker->clients)
+		client_close(worker->clients);
+	return NULL;
+}
+
+static int listen_socket(struct event_collector *collector)
+{
+	const struct event_collector_config *config = &collector->config;
+	struct addrinfo hints, *result = NULL, *rp;
+	char port_str[16];
+	int fd = -1, one = 1;
+	
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	snprintf(port_str, sizeof(port_str), "%u",
+	         config->any_port ? 0 : config->port ? config->port : EVENT_STREAM_PORT);
+	if (getaddrinfo(config->bind_addr, port_str, &hints, &result) != 0)
+		return -1;
+	
+	for (rp = result; rp; rp = rp->ai_next) {
+		fd = socket(rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		            rp->ai_protocol);
+		if (fd < 0)
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(fd, rp->ai_addr, rp->ai_addrlen) == 0 && listen(fd, 1024) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(result);
+	return fd;
+}
+
+struct event_collector *event_collector_create(const struct event_collector_config *config)
+{
+	struct event_collector *collector;
+	struct sockaddr_storage addr;
+	socklen_t addrlen = sizeof(addr);
+	struct epoll_event ev;
+	unsigned int i;
+	
+	if (!config || (!config->fn && !config->batch_fn))
+		return NULL;
+	
+	collector = calloc(1, sizeof(*collector));
+	if (!collector)
+		return NULL;
+	
+	collector->config = *config;
+	if (!collector->config.max_clients)
+		collector->config.max_clients = 1024;
+	if (!collector->config.workers)
+		collector->config.workers = 1;
+	collector->listen_fd = -1;
+	pthread_mutex_init(&collector->lock, NULL);
+	pthread_mutex_init(&collector->nodes_lock, NULL);
+	
+	collector->workers = calloc(collector->config.workers, sizeof(*collector->workers));
+	if (!collector->workers)
+		goto err;
+	for (i = 0; i < collector->config.workers; i++)
+		collector->workers[i].epoll_fd = -1;
+
+#ifdef ENABLE_TLS
+	if (config->tls) {
+		collector->ssl_ctx = SSL_CTX_new(TLS_server_method());
+		if (!collector->ssl_ctx || !config->tls_cert || !config->tls_key ||
+		    !SSL_CTX_use_certificate_file(collector->ssl_ctx, config->tls_cert, SSL_FILETYPE_PEM) ||
+		    !SSL_CTX_use_PrivateKey_file(collector->ssl_ctx, config->tls_key, SSL_FILETYPE_PEM))
+			goto err;
+	}
+#else
+	/* TLS not supported in this build */
+	if (config->tls)
+		goto err;
+#endif
+
+	collector->listen_fd = listen_socket(collector);
+	if (collector->listen_fd < 0 ||
+	    getsockname(collector->listen_fd, (struct sockaddr *)&addr, &addrlen) < 0)
+		goto err;
+	collector->port = ntohs(addr.ss_family == AF_INET6 ?
+	                        ((struct sockaddr_in6 *)&addr)->sin6_port :
+	                        ((struct sockaddr_in *)&addr)->sin_port);
+	
+	/* Each connection wakes only one of the workers */
+	for (i = 0; i < collector->config.workers; i++) {
+		struct collector_worker *worker = &collector->workers[i];
+	
+		worker->collector = collector;
+		worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+		ev.data.ptr = LISTEN_TAG;
+		if (worker->epoll_fd < 0 ||
+		    epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, collector->listen_fd, &ev) < 0)
+			goto err;
+	}
+	
+	atomic_store(&collector->running, true);
+	for (i = 0; i < collector->config.workers; i++) {
+		if (pthread_create(&collector->workers[i].thread, NULL, worker_thread,
+		                   &collector->workers[i]) != 0)
+			goto err;
+		collector->workers[i].started = true;
+	}
+	
+	return collector;
+
+err:
+	event_collector_destroy(collector);
+	return NULL;
+}
+
+void event_collector_destroy(struct event_collector *collector)
+{
+	struct collector_node *node, *next;
+	
+	if (!collector)
+		return;
+	
+	atomic_store(&collector->running, false);
+	for (unsigned int i = 0; collector->workers && i < collector->config.workers; i++) {
+		struct collector_worker *worker = &collector->workers[i];
+	
+		if (worker->started)
+			pthread_join(worker->thread, NULL);
+		if (worker->epoll_fd >= 0)
+			close(worker->epoll_fd);
+		free(worker->raw);
+		free(worker->records);
+	}
+	
+	if (collector->listen_fd >= 0)
+		close(collector->listen_fd);
+#ifdef ENABLE_TLS
+	if (collector->ssl_ctx)
+		SSL_CTX_free(collector->ssl_ctx);
+#endif
+
+	for (unsigned int i = 0; i < NODE_BUCKETS; i++) {
+		for (node = collector->nodes[i]; node; node = next) {
+			next = node->next;
+			pthread_mutex_destroy(&node->lock);
+			free(node);
+		}
+	}
+	
+	free(collector->workers);
+	pthread_mutex_destroy(&collector->nodes_lock);
+	pthread_mutex_destroy(&collector->lock);
+	free(collector);
+}
+
+uint16_t event_collector_port(const struct event_collector *collector)
+{
+	return collector ? collector->port : 0;
+}
+
+void event_collector_get_stats(struct event_collector *collector,
+                               struct event_collector_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (!collector)
+		return;
+	
+	pthread_mutex_lock(&collector->lock);
+	*stats = collector->stats;
+	pthread_mutex_unlock(&collector->lock);
+	stats->clients = atomic_load(&collector->nclients);
+}
@@ -0,0 +1,947 @@
+/* event_stream.c - Batched, compressed event streaming, exporter side
+ *
+ * Events are appended to the batch being filled as binary records. A
+ * sealed batch is compressed once into its frame, which is what gets
+ * queued, sent, resent and spilled. Sealed batches move through three
+ * stages in order: the spill file, the memory queue, then the in-flight
+ * list until acknowledged. The spill file only ever holds batches older
+ * than the memory queue, so the collector sees them in sequence.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "event_stream.h"
+#include "event_processor.h"
+#include "json_buf.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <zlib.h>
+
+#ifdef ENABLE_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+#define ALIGN8(x) (((x) + 7) & ~(size_t)7)
+
+_Static_assert(sizeof(struct event_stream_frame) == 32, "frame header is part of the protocol");
+
+/* A sealed batch, its frame ready to write */
+struct stream_batch {
+	struct stream_batch *next;
+	uint64_t seq;
+	uint32_t count;
+	bool sent;                      /* Written on the current connection */
+	uint64_t sent_ns;
+	size_t len;
+	unsigned char frame[];
+};
+
+struct batch_list {
+	struct stream_batch *head;
+	struct stream_batch *tail;
+	unsigned int count;
+	size_t bytes;
+};
+
+struct event_stream {
+	struct event_stream_config config;
+	char node[EVENT_STREAM_NODE_SIZE];
+	
+	int sock;
+	bool connected;
+	time_t last_attempt;
+#ifdef ENABLE_TLS
+	SSL_CTX *ssl_ctx;
+	SSL *ssl;
+#endif
+
+	/* Acknowledgment frame being read */
+	unsigned char rx[sizeof(struct event_stream_frame)];
+	size_t rx_len;
+	
+	/* Batch being filled */
+	struct json_buf cur;
+	uint32_t cur_count;
+	uint64_t cur_first_ns;
+	uint64_t next_seq;
+	uint64_t acked_seq;             /* Highest the collector has */
+	
+	/* Compression output */
+	unsigned char *zbuf;
+	size_t zbuf_size;
+	
+	struct batch_list inflight;
+	struct batch_list queue;
+	
+	/* Spill file, frames from spill_read to spill_size wait to be sent */
+	int spill_fd;
+	off_t spill_read;
+	off_t spill_size;
+	
+	/* Statistics */
+	uint64_t events;
+	uint64_t batches;
+	uint64_t batches_acked;
+	uint64_t bytes_raw;
+	uint64_t bytes_sent;
+	uint64_t spilled;
+	uint64_t dropped;
+	uint32_t reconnections;
+	
+	pthread_mutex_t lock;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void frame_encode(struct event_stream_frame *out, uint16_t type, uint16_t codec,
+                         uint64_t seq, uint32_t len, uint32_t raw_len, uint32_t count,
+                         uint32_t crc)
+{
+	out->magic = htole32(EVENT_STREAM_MAGIC);
+	out->type = htole16(type);
+	out->codec = htole16(codec);
+	out->seq = htole64(seq);
+	out->len = htole32(len);
+	out->raw_len = htole32(raw_len);
+	out->count = htole32(count);
+	out->crc = htole32(crc);
+}
+
+static void frame_decode(struct event_stream_frame *frame)
+{
+	frame->magic = le32toh(frame->magic);
+	frame->type = le16toh(frame->type);
+	frame->codec = le16toh(frame->codec);
+	frame->seq = le64toh(frame->seq);
+	frame->len = le32toh(frame->len);
+	frame->raw_len = le32toh(frame->raw_len);
+	frame->count = le32toh(frame->count);
+	frame->crc = le32toh(frame->crc);
+}
+
+static void list_push(struct batch_list *list, struct stream_batch *batch)
+{
+	batch->next = NULL;
+	if (list->tail)
+		list->tail->next = batch;
+	else
+		list->head = batch;
+	list->tail = batch;
+	list->count++;
+	list->bytes += batch->len;
+}
+
+static struct stream_batch *list_pop(struct batch_list *list)
+{
+	struct stream_batch *batch = list->head;
+	
+	if (!batch)
+		return NULL;
+	list->head = batch->next;
+	if (!list->head)
+		list->tail = NULL;
+	list->count--;
+	list->bytes -= batch->len;
+	return batch;
+}
+
+static void list_free(struct batch_list *list)
+{
+	struct stream_batch *batch;
+	
+	while ((batch = list_pop(list)))
+		free(batch);
+}
+
+/* Connection */
+
+static bool connect_tcp(struct event_stream *stream)
+{
+	struct addrinfo hints, *result, *rp;
+	struct timeval tv;
+	char port_str[16];
+	int sock = -1, one = 1;
+	
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	
+	snprintf(port_str, sizeof(port_str), "%u", stream->config.port);
+	
+	if (getaddrinfo(stream->config.server, port_str, &hints, &result) != 0)
+		return false;
+	
+	for (rp = result; rp != NULL; rp = rp->ai_next) {
+		sock = socket(rp->ai_family, rp->ai_socktype | SOCK_CLOEXEC, rp->ai_protocol);
+		if (sock == -1)
+			continue;
+	
+		if (connect(sock, rp->ai_addr, rp->ai_addrlen) == 0)
+			break;
+	
+		close(sock);
+		sock = -1;
+	}
+	
+	freeaddrinfo(result);
+	
+	if (sock == -1)
+		return false;
+	
+	/* A collector that stops reading fails the write instead of hanging it */
+	tv.tv_sec = stream->config.ack_timeout_ms / 1000;
+	tv.tv_usec = (stream->config.ack_timeout_ms % 1000) * 1000;
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	
+	stream->sock = sock;
+	stream->connected = true;
+	return true;
+}
+
+#ifdef ENABLE_TLS
+static bool connect_tls(struct event_stream *stream)
+{
+	if (!connect_tcp(stream))
+		return false;
+	
+	stream->ssl_ctx = SSL_CTX_new(TLS_client_method());
+	if (!stream->ssl_ctx)
+		return false;
+	
+	if (stream->config.tls_ca) {
+		if (!SSL_CTX_load_verify_locations(stream->ssl_ctx, stream->config.tls_ca, NULL))
+			return false;
+		SSL_CTX_set_verify(stream->ssl_ctx, SSL_VERIFY_PEER, NULL);
+	}
+	
+	if (stream->config.tls_cert && stream->config.tls_key) {
+		if (!SSL_CTX_use_certificate_file(stream->ssl_ctx, stream->config.tls_cert,
+		                                  SSL_FILETYPE_PEM) ||
+		    !SSL_CTX_use_PrivateKey_file(stream->ssl_ctx, stream->config.tls_key,
+		                                 SSL_FILETYPE_PEM))
+			return false;
+	}
+	
+	stream->ssl = SSL_new(stream->ssl_ctx);
+	if (!stream->ssl)
+		return false;
+	
+	SSL_set_fd(stream->ssl, stream->sock);
+	return SSL_connect(stream->ssl) == 1;
+}
+#endif
+
+static void close_connection(struct event_stream *stream)
+{
+	struct stream_batch *batch;
+
+#ifdef ENABLE_TLS
+	if (stream->ssl) {
+		SSL_shutdown(stream->ssl);
+		SSL_free(stream->ssl);
+		stream->ssl = NULL;
+	}
+	if (stream->ssl_ctx) {
+		SSL_CTX_free(stream->ssl_ctx);
+		stream->ssl_ctx = NULL;
+	}
+#endif
+
+	if (stream->sock >= 0) {
+		close(stream->sock);
+		stream->sock = -1;
+	}
+	
+	/* Whatever was in flight goes again on the next connection */
+	for (batch = stream->inflight.head; batch; batch = batch->next)
+		batch->sent = false;
+	
+	stream->rx_len = 0;
+	stream->connected = false;
+}
+
+static bool stream_write(struct event_stream *stream, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	ssize_t n;
+	
+	while (len > 0) {
+#ifdef ENABLE_TLS
+		if (stream->ssl) {
+			n = SSL_write(stream->ssl, p, (int)len);
+			if (n <= 0)
+				return false;
+		} else
+#endif
+		{
+			n = send(stream->sock, p, len, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+	
+	stream->bytes_sent += (uint64_t)(p - (const unsigned char *)data);
+	return true;
+}
+
+/* Read up to len bytes, waiting at most timeout_ms; 0 if none came, -1 on error */
+static ssize_t stream_read(struct event_stream *stream, void *buf, size_t len, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = stream->sock, .events = POLLIN };
+	ssize_t n;
+
+#ifdef ENABLE_TLS
+	if (stream->ssl && SSL_pending(stream->ssl) > 0)
+		timeout_ms = 0;
+	else
+#endif
+	if (poll(&pfd, 1, timeout_ms) <= 0)
+		return 0;
+
+#ifdef ENABLE_TLS
+	if (stream->ssl) {
+		n = SSL_read(stream->ssl, buf, (int)len);
+		return n > 0 ? n : -1;
+	}
+#endif
+
+	n = recv(stream->sock, buf, len, MSG_DONTWAIT);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	return n > 0 ? n : -1;
+}
+
+/* Read one collector frame, true once a whole one is in rx */
+static bool read_frame(struct event_stream *stream, int timeout_ms, struct event_stream_frame *out)
+{
+	ssize_t n;
+	
+	n = stream_read(stream, stream->rx + stream->rx_len, sizeof(stream->rx) - stream->rx_len,
+	                timeout_ms);
+	if (n < 0) {
+		close_connection(stream);
+		return false;
+	}
+	stream->rx_len += (size_t)n;
+	if (stream->rx_len < sizeof(stream->rx))
+		return false;
+	
+	memcpy(out, stream->rx, sizeof(*out));
+	stream->rx_len = 0;
+	frame_decode(out);
+	
+	/* Collector frames carry no payload */
+	if (out->magic != EVENT_STREAM_MAGIC || out->len != 0) {
+		close_connection(stream);
+		return false;
+	}
+	return true;
+}
+
+/* Batches up to seq are with the collector */
+static void acknowledge(struct event_stream *stream, uint64_t seq)
+{
+	struct stream_batch *batch;
+	
+	if (seq > stream->acked_seq)
+		stream->acked_seq = seq;
+	
+	while (stream->inflight.head && stream->inflight.head->seq <= stream->acked_seq) {
+		batch = list_pop(&stream->inflight);
+		if (batch->sent)
+			stream->batches_acked++;
+		free(batch);
+	}
+	while (stream->queue.head && stream->queue.head->seq <= stream->acked_seq)
+		free(list_pop(&stream->queue));
+}
+
+static bool handshake(struct event_stream *stream)
+{
+	struct event_stream_frame frame;
+	struct event_stream_hello hello;
+	uint64_t deadline;
+	
+	memset(&hello, 0, sizeof(hello));
+	hello.version = htole16(EVENT_STREAM_VERSION);
+	hello.big_endian = __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+	hello.event_size = htole32(sizeof(struct binexp_event));
+	memcpy(hello.node, stream->node, sizeof(hello.node));
+	
+	frame_encode(&frame, EVENT_STREAM_HELLO, EVENT_STREAM_CODEC_NONE, 0, sizeof(hello),
+	             sizeof(hello), 0, 0);
+	if (!stream_write(stream, &frame, sizeof(frame)) || !stream_write(stream, &hello, sizeof(hello)))
+		return false;
+	
+	/* The collector tells which batches it already has */
+	deadline = now_ns() + stream->config.ack_timeout_ms * 1000000ULL;
+	while (stream->connected && now_ns() < deadline) {
+		if (!read_frame(stream, 100, &frame))
+			continue;
+		if (frame.type != EVENT_STREAM_WELCOME)
+			return false;
+		acknowledge(stream, frame.seq);
+		return true;
+	}
+	return false;
+}
+
+static bool reconnect_locked(struct event_stream *stream)
+{
+	bool success;
+	
+	close_connection(stream);
+	stream->last_attempt = time(NULL);
+
+#ifdef ENABLE_TLS
+	success = stream->config.tls ? connect_tls(stream) : connect_tcp(stream);
+#else
+	/* TLS not supported in this build */
+	success = !stream->config.tls && connect_tcp(stream);
+#endif
+
+	if (success)
+		success = handshake(stream);
+	if (!success) {
+		close_connection(stream);
+		return false;
+	}
+	
+	stream->reconnections++;
+	return true;
+}
+
+/* Spill file */
+
+/* Header of the frame at off, false at the end or on a damaged frame */
+static bool spill_peek(struct event_stream *stream, off_t off, struct event_stream_frame *frame)
+{
+	if (off + (off_t)sizeof(*frame) > stream->spill_size ||
+	    pread(stream->spill_fd, frame, sizeof(*frame), off) != (ssize_t)sizeof(*frame))
+		return false;
+	
+	frame_decode(frame);
+	return frame->magic == EVENT_STREAM_MAGIC && frame->type == EVENT_STREAM_BATCH &&
+	       frame->len <= EVENT_STREAM_MAX_FRAME &&
+	       off + (off_t)sizeof(*frame) + frame->len <= stream->spill_size;
+}
+
+static void spill_reset(struct event_stream *stream)
+{
+	if (ftruncate(stream->spill_fd, 0) == 0) {
+		stream->spill_read = 0;
+		stream->spill_size = 0;
+	}
+}
+
+/* Open the spill file, keeping the batches a previous run left */
+static bool spill_open(struct event_stream *stream)
+{
+	struct event_stream_frame frame;
+	struct stat st;
+	off_t off = 0;
+	
+	stream->spill_fd = open(stream->config.spill_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (stream->spill_fd < 0 || fstat(stream->spill_fd, &st) < 0)
+		return false;
+	
+	stream->spill_size = st.st_size;
+	while (spill_peek(stream, off, &frame)) {
+		if (frame.seq >= stream->next_seq)
+			stream->next_seq = frame.seq + 1;
+		off += sizeof(frame) + frame.len;
+	}
+	
+	/* A frame cut short by a crash ends the file */
+	if (off != stream->spill_size && ftruncate(stream->spill_fd, off) == 0)
+		stream->spill_size = off;
+	if (off == 0)
+		spill_reset(stream);
+	return true;
+}
+
+static bool spill_append(struct event_stream *stream, const struct stream_batch *batch)
+{
+	if (stream->spill_fd < 0 ||
+	    stream->spill_size + (off_t)batch->len > (off_t)stream->config.spill_limit)
+		return false;
+	
+	if (pwrite(stream->spill_fd, batch->frame, batch->len, stream->spill_size) != (ssize_t)batch->len)
+		return false;
+	
+	stream->spill_size += batch->len;
+	stream->spilled++;
+	return true;
+}
+
+/* Next batch of the spill file, NULL once it is empty */
+static struct stream_batch *spill_take(struct event_stream *stream)
+{
+	struct event_stream_frame frame;
+	struct stream_batch *batch;
+	size_t len;
+	
+	while (stream->spill_fd >= 0 && stream->spill_read < stream->spill_size) {
+		if (!spill_peek(stream, stream->spill_read, &frame)) {
+			spill_reset(stream);
+			break;
+		}
+	
+		len = sizeof(frame) + frame.len;
+		if (frame.seq <= stream->acked_seq) {
+			stream->spill_read += len;
+			continue;
+		}
+	
+		batch = malloc(sizeof(*batch) + len);
+		if (!batch)
+			return NULL;
+		if (pread(stream->spill_fd, batch->frame, len, stream->spill_read) != (ssize_t)len) {
+			free(batch);
+			spill_reset(stream);
+			break;
+		}
+	
+		batch->seq = frame.seq;
+		batch->count = frame.count;
+		batch->sent = false;
+		batch->len = len;
+		stream->spill_read += len;
+		if (stream->spill_read == stream->spill_size)
+			spill_reset(stream);
+		return batch;
+	}
+	
+	if (stream->spill_fd >= 0 && stream->spill_size)
+		spill_reset(stream);
+	return NULL;
+}
+
+/* Move queued batches to the spill file until memory is within its limit */
+static void spill_overflow(struct event_stream *stream)
+{
+	struct stream_batch *batch;
+	
+	while (stream->queue.bytes > stream->config.memory_limit) {
+		batch = list_pop(&stream->queue);
+		if (!spill_append(stream, batch))
+			stream->dropped += batch->count;
+		free(batch);
+	}
+}
+
+/* Sending */
+
+/* Compress the batch being filled into a queued frame */
+static bool seal_batch(struct event_stream *stream)
+{
+	struct event_stream_frame frame;
+	struct stream_batch *batch;
+	uLongf zlen = stream->zbuf_size;
+	const unsigned char *payload;
+	uint16_t codec;
+	uint32_t crc;
+	
+	if (stream->cur_count == 0)
+		return true;
+	
+	if (stream->cur.failed) {
+		stream->dropped += stream->cur_count;
+		goto out;
+	}
+	
+	crc = (uint32_t)crc32(0, (const Bytef *)stream->cur.data, stream->cur.len);
+	payload = (const unsigned char *)stream->cur.data;
+	codec = EVENT_STREAM_CODEC_NONE;
+	zlen = stream->cur.len;
+	
+	if (stream->config.level >= 0) {
+		uLongf bound = compressBound(stream->cur.len);
+	
+		if (bound > stream->zbuf_size) {
+			unsigned char *zbuf = realloc(stream->zbuf, bound);
+			if (zbuf) {
+				stream->zbuf = zbuf;
+				stream->zbuf_size = bound;
+			}
+		}
+		zlen = stream->zbuf_size;
+		if (bound <= stream->zbuf_size &&
+		    compress2(stream->zbuf, &zlen, (const Bytef *)stream->cur.data, stream->cur.len,
+		              stream->config.level) == Z_OK && zlen < stream->cur.len) {
+			payload = stream->zbuf;
+			codec = EVENT_STREAM_CODEC_DEFLATE;
+		} else {
+			zlen = stream->cur.len;
+		}
+	}
+	
+	batch = malloc(sizeof(*batch) + sizeof(frame) + zlen);
+	if (!batch) {
+		stream->dropped += stream->cur_count;
+		goto out;
+	}
+	
+	batch->seq = stream->next_seq++;
+	batch->count = stream->cur_count;
+	batch->sent = false;
+	batch->len = sizeof(frame) + zlen;
+	frame_encode(&frame, EVENT_STREAM_BATCH, codec, batch->seq, (uint32_t)zlen,
+	             (uint32_t)stream->cur.len, stream->cur_count, crc);
+	memcpy(batch->frame, &frame, sizeof(frame));
+	memcpy(batch->frame + sizeof(frame), payload, zlen);
+	
+	stream->batches++;
+	stream->bytes_raw += stream->cur.len;
+	list_push(&stream->queue, batch);
+	spill_overflow(stream);
+
+out:
+	json_buf_reset(&stream->cur);
+	stream->cur_count = 0;
+	return true;
+}
+
+/* Read the acknowledgments that arrived */
+static void read_acks(struct event_stream *stream, int timeout_ms)
+{
+	struct event_stream_frame frame;
+	
+	while (stream->connected && read_frame(stream, timeout_ms, &frame)) {
+		if (frame.type == EVENT_STREAM_ACK)
+			acknowledge(stream, frame.seq);
+		timeout_ms = 0;
+	}
+}
+
+/* Send what the window allows, connecting first if it is time to retry */
+static bool pump_locked(struct event_stream *stream)
+{
+	struct stream_batch *batch;
+	uint64_t now = now_ns();
+	
+	if (!stream->connected) {
+		if (!stream->inflight.count && !stream->queue.count &&
+		    stream->spill_read == stream->spill_size)
+			return true;
+		if (time(NULL) - stream->last_attempt < (time_t)stream->config.reconnect_interval ||
+		    !reconnect_locked(stream))
+			return false;
+	}
+	
+	read_acks(stream, 0);
+	
+	/* A collector that stopped acknowledging gets a new connection */
+	if (stream->connected && stream->inflight.head && stream->inflight.head->sent &&
+	    now - stream->inflight.head->sent_ns > stream->config.ack_timeout_ms * 1000000ULL)
+		close_connection(stream);
+	
+	/* Resend after a reconnect, in order */
+	for (batch = stream->inflight.head; batch && stream->connected; batch = batch->next) {
+		if (batch->sent)
+			continue;
+		if (!stream_write(stream, batch->frame, batch->len)) {
+			close_connection(stream);
+			break;
+		}
+		batch->sent = true;
+		batch->sent_ns = now;
+	}
+	
+	/* Then the oldest waiting batches, spilled ones first */
+	while (stream->connected && stream->inflight.count < stream->config.window) {
+		batch = spill_take(stream);
+		if (!batch)
+			batch = list_pop(&stream->queue);
+		if (!batch)
+			break;
+	
+		list_push(&stream->inflight, batch);
+		if (!stream_write(stream, batch->frame, batch->len)) {
+			close_connection(stream);
+			break;
+		}
+		batch->sent = true;
+		batch->sent_ns = now;
+		read_acks(stream, 0);
+	}
+	
+	return stream->connected && !stream->queue.count && stream->spill_read == stream->spill_size;
+}
+
+/* Append a record to the batch being filled */
+static void copy_name(char *dst, const char *src, size_t size)
+{
+	size_t len = strnlen(src, size);
+	
+	if (len >= BINEXP_NAME_SIZE)
+		len = BINEXP_NAME_SIZE - 1;
+	memcpy(dst, src, len);
+}
+
+static void append_record(struct event_stream *stream, const struct nlmon_event *event)
+{
+	struct binexp_record rec = { .type = BINEXP_RECORD_EVENT };
+	static const char zeros[8];
+	struct event_bus_record body;
+	size_t raw_len = 0, len;
+	
+	memset(&body, 0, sizeof(body));
+	binexp_event_fill(&body.event, event);
+	copy_name(body.interface, event->interface, sizeof(event->interface));
+	copy_name(body.genl_family, event->netlink.genl_family_name,
+	          sizeof(event->netlink.genl_family_name));
+	
+	if (stream->config.include_raw && event->raw_msg && event->raw_msg_len < UINT32_MAX - 64)
+		raw_len = event->raw_msg_len;
+	body.event.raw_len = (uint32_t)raw_len;
+	
+	len = sizeof(rec) + sizeof(body) + raw_len;
+	rec.length = (uint32_t)ALIGN8(len);
+	json_buf_append(&stream->cur, (const char *)&rec, sizeof(rec));
+	json_buf_append(&stream->cur, (const char *)&body, sizeof(body));
+	if (raw_len) {
+		json_buf_append(&stream->cur, (const char *)event->raw_msg, raw_len);
+		json_buf_append(&stream->cur, zeros, ALIGN8(len) - len);
+	}
+}
+
+static void stream_free(struct event_stream *stream)
+{
+	if (stream->spill_fd >= 0) {
+		if (stream->spill_size == 0)
+			unlink(stream->config.spill_path);
+		close(stream->spill_fd);
+	}
+	
+	json_buf_free(&stream->cur);
+	free(stream->zbuf);
+	free((void *)stream->config.server);
+	free((void *)stream->config.tls_cert);
+	free((void *)stream->config.tls_key);
+	free((void *)stream->config.tls_ca);
+	free((void *)stream->config.spill_path);
+	pthread_mutex_destroy(&stream->lock);
+	free(stream);
+}
+
+struct event_stream *event_stream_create(const struct event_stream_config *config)
+{
+	struct event_stream *stream;
+	struct timespec ts;
+	
+	if (!config || !config->server)
+		return NULL;
+	
+	stream = calloc(1, sizeof(*stream));
+	if (!stream)
+		return NULL;
+	
+	stream->config = *config;
+	stream->config.server = strdup(config->server);
+	stream->config.tls_cert = config->tls_cert ? strdup(config->tls_cert) : NULL;
+	stream->config.tls_key = config->tls_key ? strdup(config->tls_key) : NULL;
+	stream->config.tls_ca = config->tls_ca ? strdup(config->tls_ca) : NULL;
+	stream->config.spill_path = config->spill_path ? strdup(config->spill_path) : NULL;
+	stream->config.node = NULL;
+	
+	if (!stream->config.port)
+		stream->config.port = EVENT_STREAM_PORT;
+	if (stream->config.level == 0)
+		stream->config.level = 1;
+	if (stream->config.level > 9)
+		stream->config.level = 9;
+	if (!stream->config.batch_events)
+		stream->config.batch_events = EVENT_STREAM_BATCH_EVENTS;
+	if (!stream->config.batch_bytes)
+		stream->config.batch_bytes = EVENT_STREAM_BATCH_BYTES;
+	if (stream->config.batch_bytes > EVENT_STREAM_MAX_FRAME / 2)
+		stream->config.batch_bytes = EVENT_STREAM_MAX_FRAME / 2;
+	if (!stream->config.batch_delay_ms)
+		stream->config.batch_delay_ms = EVENT_STREAM_BATCH_DELAY_MS;
+	if (!stream->config.window)
+		stream->config.window = EVENT_STREAM_WINDOW;
+	if (!stream->config.memory_limit)
+		stream->config.memory_limit = EVENT_STREAM_MEMORY_DEFAULT;
+	if (!stream->config.spill_limit)
+		stream->config.spill_limit = EVENT_STREAM_SPILL_DEFAULT;
+	if (!stream->config.reconnect_interval)
+		stream->config.reconnect_interval = 5;
+	if (!stream->config.ack_timeout_ms)
+		stream->config.ack_timeout_ms = 10000;
+	
+	if (config->node)
+		strncpy(stream->node, config->node, sizeof(stream->node) - 1);
+	else if (gethostname(stream->node, sizeof(stream->node)) == 0)
+		stream->node[sizeof(stream->node) - 1] = '\0';
+	
+	/* Sequences stay above those of earlier runs, spilled batches included */
+	clock_gettime(CLOCK_REALTIME, &ts);
+	stream->next_seq = (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+	
+	stream->sock = -1;
+	stream->spill_fd = -1;
+	pthread_mutex_init(&stream->lock, NULL);
+	
+	if (!stream->config.server || !stream->node[0] ||
+	    !json_buf_init(&stream->cur, stream->config.batch_bytes + 4096) ||
+	    (stream->config.spill_path && !spill_open(stream))) {
+		stream_free(stream);
+		return NULL;
+	}
+	
+	/* Initial connection, sends what a previous run spilled */
+	pthread_mutex_lock(&stream->lock);
+	pump_locked(stream);
+	pthread_mutex_unlock(&stream->lock);
+	
+	return stream;
+}
+
+/* Write what is not acknowledged back to the spill file, oldest first */
+static void spill_persist(struct event_stream *stream)
+{
+	struct stream_batch *batch, *spilled;
+	struct batch_list rest = {0};
+	
+	if (stream->spill_fd < 0)
+		return;
+	
+	/* In flight and spilled batches are all older than the queue */
+	while ((batch = list_pop(&stream->inflight)))
+		list_push(&rest, batch);
+	while ((spilled = spill_take(stream)))
+		list_push(&rest, spilled);
+	while ((batch = list_pop(&stream->queue)))
+		list_push(&rest, batch);
+	
+	spill_reset(stream);
+	while ((batch = list_pop(&rest))) {
+		if (!spill_append(stream, batch))
+			stream->dropped += batch->count;
+		free(batch);
+	}
+}
+
+void event_stream_destroy(struct event_stream *stream)
+{
+	uint64_t deadline;
+	
+	if (!stream)
+		return;
+	
+	pthread_mutex_lock(&stream->lock);
+	
+	seal_batch(stream);
+	
+	/* Give the collector time to take the rest */
+	deadline = now_ns() + stream->config.ack_timeout_ms * 1000000ULL;
+	while (pump_locked(stream) || stream->connected) {
+		if (!stream->inflight.count && !stream->queue.count &&
+		    stream->spill_read == stream->spill_size)
+			break;
+		if (now_ns() >= deadline)
+			break;
+		read_acks(stream, 50);
+	}
+	spill_persist(stream);
+	
+	close_connection(stream);
+	list_free(&stream->inflight);
+	list_free(&stream->queue);
+	pthread_mutex_unlock(&stream->lock);
+	
+	stream_free(stream);
+}
+
+bool event_stream_write_event(struct event_stream *stream, const struct nlmon_event *event)
+{
+	uint64_t now;
+	
+	if (!stream || !event)
+		return false;
+	
+	now = now_ns();
+	
+	pthread_mutex_lock(&stream->lock);
+	
+	if (stream->cur_count == 0)
+		stream->cur_first_ns = now;
+	append_record(stream, event);
+	stream->cur_count++;
+	stream->events++;
+	
+	if (stream->cur_count >= stream->config.batch_events ||
+	    stream->cur.len >= stream->config.batch_bytes ||
+	    now - stream->cur_first_ns >= stream->config.batch_delay_ms * 1000000ULL) {
+		seal_batch(stream);
+		pump_locked(stream);
+	} else if (stream->connected && stream->inflight.count) {
+		read_acks(stream, 0);
+	}
+	
+	pthread_mutex_unlock(&stream->lock);
+	return true;
+}
+
+bool event_stream_flush(struct event_stream *stream)
+{
+	bool success;
+	
+	if (!stream)
+		return false;
+	
+	pthread_mutex_lock(&stream->lock);
+	seal_batch(stream);
+	success = pump_locked(stream);
+	pthread_mutex_unlock(&stream->lock);
+	
+	return success;
+}
+
+void event_stream_get_stats(struct event_stream *stream, struct event_stream_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (!stream)
+		return;
+	
+	pthread_mutex_lock(&stream->lock);
+	stats->events = stream->events;
+	stats->batches = stream->batches;
+	stats->batches_acked = stream->batches_acked;
+	stats->bytes_raw = stream->bytes_raw;
+	stats->bytes_sent = stream->bytes_sent;
+	stats->spilled = stream->spilled;
+	stats->spill_bytes = (uint64_t)(stream->spill_size - stream->spill_read);
+	stats->dropped = stream->dropped;
+	stats->reconnections = stream->reconnections;
+	stats->connected = stream->connected;
+	pthread_mutex_unlock(&stream->lock);
+}
@@ -1,17 +1,645 @@
-/* export_layer.c - Unified export layer implementation */
+/* export_layer.c - Unified export layer implementation
+ *
+ * Each enabled exporter gets a bounded queue of event references and a
+ * worker thread draining it in chunks. Queue positions count every event
+ * ever queued, dropped ones included, so a flush takes a ticket and waits
+ * until the worker has passed the position the queue had at the time and
+ * flushed the exporter. Workers of exporters with timed work, such as
+ * sending a batch that waited long enough, also wake while idle.
+ *
+ * A worker samples the events it takes when its exporter has a sampler.
+ * Events are shared by every queue, so one written with a sample weight
+ * is a copy of the queued event with the weight set.
+ */
 
 #include "export_layer.h"
+#include "event_processor.h"
+#include "thread_affinity.h"
+#include "pipeline_watchdog.h"
+#include "nlmon_probes.h"
+#include "stats_bus.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+
+/* Default events per export queue */
+#define DEFAULT_QUEUE_SIZE 4096
+
+/* Events a worker takes from its queue at a time */
+#define WORKER_CHUNK 64
+
+/* Idle wakeup interval of workers with timed work */
+#define TICK_MS 100
+
+/* Event types whose Prometheus counter handle is kept */
+#define PROM_EVENT_TYPES 64
+
+struct export_layer;
+
+/* Queued event */
+struct export_entry {
+	struct nlmon_event *event;
+	uint64_t queued_ns;
+	struct nlmon_event_trace trace;  /* The event's own is finished by its handlers */
+};
+
+/* Queue and worker of one exporter */
+struct export_queue {
+	struct export_layer *layer;
+	enum export_target target;
+	enum export_overflow overflow;
+	
+	/* Ring of entries, guarded by lock */
+	struct export_entry *entries;
+	size_t size;
+	size_t head;
+	size_t count;
+	uint64_t tail_pos;              /* Entries ever queued */
+	
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;       /* Signalled to the worker */
+	pthread_cond_t not_full;        /* Signalled to blocked producers */
+	pthread_cond_t flushed;
+	pthread_t worker;
+	bool running;
+	
+	/* Flush barrier */
+	uint64_t flush_requested;       /* Tickets taken */
+	uint64_t flush_done;            /* Tickets served */
+	uint64_t flush_pos;             /* Position the newest ticket waits for */
+	bool flush_ok;                  /* Whether the last exporter flush worked */
+	
+	/* Statistics, guarded by lock */
+	uint64_t queued;
+	uint64_t exported;
+	uint64_t failed;
+	uint64_t dropped;
+	uint64_t sampled;
+	uint64_t held;
+	uint64_t lag_max_us;
+};
 
 struct export_layer {
 	struct pcap_exporter *pcap;
 	struct json_exporter *json;
+	struct binary_exporter *binary;
+	struct event_bus *bus;
+	struct event_stream *stream;
+	struct otlp_exporter *otlp;
 	struct prometheus_exporter *prometheus;
 	struct syslog_forwarder *syslog;
 	struct log_rotator *log_rotator;
+	
+	/* nlmon_events_total handles by event type, filled on first use */
+	_Atomic(struct prometheus_metric *) prom_events[PROM_EVENT_TYPES];
+	
+	bool sync_export;
+	struct export_queue *queues[EXPORT_TARGET_COUNT];
+	
+	/* Used by the target's worker, or the caller with sync_export */
+	struct event_sampler *samplers[EXPORT_TARGET_COUNT];
+};
+
+/* Where a sampler hands its reservoir events */
+struct sample_export {
+	struct export_layer *layer;
+	enum export_target target;
+	uint64_t exported;
+	uint64_t failed;
+};
+
+/* Worker thread names */
+static const char *const target_names[EXPORT_TARGET_COUNT] = {
+	[EXPORT_TARGET_PCAP] = "export-pcap",
+	[EXPORT_TARGET_JSON] = "export-json",
+	[EXPORT_TARGET_PROMETHEUS] = "export-prom",
+	[EXPORT_TARGET_SYSLOG] = "export-syslog",
+	[EXPORT_TARGET_LOG] = "export-log",
+	[EXPORT_TARGET_BINARY] = "export-binary",
+	[EXPORT_TARGET_BUS] = "export-bus",
+	[EXPORT_TARGET_STREAM] = "export-stream",
+	[EXPORT_TARGET_OTLP] = "export-otlp",
 };
 
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Whether an exporter is enabled for target */
+static bool target_enabled(struct export_layer *layer, enum export_target target)
+{
+	switch (target) {
+	case EXPORT_TARGET_PCAP:
+		return layer->pcap != NULL;
+	case EXPORT_TARGET_JSON:
+		return layer->json != NULL;
+	case EXPORT_TARGET_PROMETHEUS:
+		return layer->prometheus != NULL;
+	case EXPORT_TARGET_SYSLOG:
+		return layer->syslog != NULL;
+	case EXPORT_TARGET_LOG:
+		return layer->log_rotator != NULL;
+	case EXPORT_TARGET_BINARY:
+		return layer->binary != NULL;
+	case EXPORT_TARGET_BUS:
+		return layer->bus != NULL;
+	case EXPORT_TARGET_STREAM:
+		return layer->stream != NULL;
+	case EXPORT_TARGET_OTLP:
+		return layer->otlp != NULL;
+	default:
+		return false;
+	}
+}
+
+/* " sample_weight=N" for sampled events, "" for the others */
+static const char *weight_text(const struct nlmon_event *event, char *buf, size_t size)
+{
+	if (event->sample_weight <= 1)
+		return "";
+	snprintf(buf, size, " sample_weight=%u", event->sample_weight);
+	return buf;
+}
+
+/* Write an event to one exporter */
+static bool export_write(struct export_layer *layer, enum export_target target,
+                         struct nlmon_event *event)
+{
+	char event_type[16];
+	char weight[32];
+	char text[256];
+	
+	switch (target) {
+	case EXPORT_TARGET_PCAP: {
+		struct pcap_packet_info info = {
+			.timestamp_ns = event->timestamp,
+			.interface = event->interface,
+			.comment = text,
+		};
+			
+		/* pcapng files carry the event next to the message */
+		snprintf(text, sizeof(text), "event_type=%u message_type=%u seq=%" PRIu64
+		         " protocol=%d nlmsg_seq=%u pid=%u%s",
+		         event->event_type, event->message_type, event->sequence,
+		         event->netlink.protocol, event->netlink.seq, event->netlink.pid,
+		         weight_text(event, weight, sizeof(weight)));
+			
+		/* The payload is the captured message, events without one are skipped */
+		if (event->raw_msg && event->raw_msg_len > 0)
+			return pcap_exporter_write_packet_info(layer->pcap, (const unsigned char *)event->raw_msg,
+			                                       event->raw_msg_len, &info);
+		if (!event->data || event->data_size == 0)
+			return true;
+		return pcap_exporter_write_packet_info(layer->pcap, event->data, event->data_size, &info);
+	}
+		
+	case EXPORT_TARGET_JSON: {
+		struct json_event json = {
+			.timestamp_sec = event->timestamp / 1000000000ULL,
+			.timestamp_usec = event->timestamp % 1000000000ULL / 1000,
+			.sequence = event->sequence,
+			.event_type = event_type,
+			.message_type = event->message_type,
+			.interface = event->interface[0] ? event->interface : NULL,
+			.sample_weight = event->sample_weight,
+		};
+			
+		snprintf(event_type, sizeof(event_type), "%u", event->event_type);
+		return json_exporter_write_event(layer->json, &json);
+	}
+		
+	case EXPORT_TARGET_PROMETHEUS: {
+		struct prometheus_metric *metric = NULL;
+			
+		if (event->event_type < PROM_EVENT_TYPES)
+			metric = atomic_load_explicit(&layer->prom_events[event->event_type],
+			                              memory_order_acquire);
+			
+		if (!metric) {
+			snprintf(text, sizeof(text), "type=\"%u\"", event->event_type);
+			metric = prometheus_exporter_register(layer->prometheus, "nlmon_events_total",
+			                                      text, METRIC_TYPE_COUNTER);
+			if (metric && event->event_type < PROM_EVENT_TYPES)
+				atomic_store_explicit(&layer->prom_events[event->event_type], metric,
+				                      memory_order_release);
+		}
+			
+		prometheus_metric_inc(metric, nlmon_event_weight(event));
+		return true;
+	}
+		
+	case EXPORT_TARGET_SYSLOG: {
+		struct syslog_message msg = {
+			.severity = SYSLOG_INFO,
+			.msg_id = "EVENT",
+			.message = text,
+		};
+			
+		snprintf(text, sizeof(text), "type=%u msg_type=%u interface=%s seq=%" PRIu64 "%s",
+		         event->event_type, event->message_type, event->interface,
+		         event->sequence, weight_text(event, weight, sizeof(weight)));
+		return syslog_forwarder_send(layer->syslog, &msg);
+	}
+		
+	case EXPORT_TARGET_BINARY:
+		return binary_exporter_write_event(layer->binary, event);
+		
+	case EXPORT_TARGET_BUS:
+		return event_bus_publish(layer->bus, event);
+		
+	case EXPORT_TARGET_STREAM:
+		return event_stream_write_event(layer->stream, event);
+		
+	case EXPORT_TARGET_OTLP:
+		return otlp_exporter_write_event(layer->otlp, event);
+		
+	case EXPORT_TARGET_LOG:
+		return log_rotator_printf(layer->log_rotator,
+		                          "%" PRIu64 " seq=%" PRIu64 " type=%u msg_type=%u interface=%s%s\n",
+		                          event->timestamp, event->sequence, event->event_type,
+		                          event->message_type, event->interface,
+		                          weight_text(event, weight, sizeof(weight))) >= 0;
+		
+	default:
+		return false;
+	}
+}
+
+/* Write an event to one exporter, between the export probes */
+static bool export_to(struct export_layer *layer, enum export_target target,
+                      struct nlmon_event *event)
+{
+	bool ok;
+	
+	NLMON_PROBE2(export_start, target, event->sequence);
+	ok = export_write(layer, target, event);
+	NLMON_PROBE2(export_done, target, ok);
+	return ok;
+}
+
+/* Write an event that stands for weight events of the stream */
+static bool export_weighted(struct export_layer *layer, enum export_target target,
+                            struct nlmon_event *event, uint32_t weight)
+{
+	struct nlmon_event copy;
+	uint64_t total;
+	
+	if (weight == 1)
+		return export_to(layer, target, event);
+	
+	/* Weights multiply, an event may come sampled already */
+	total = (uint64_t)nlmon_event_weight(event) * weight;
+	copy = *event;
+	copy.sample_weight = total > UINT32_MAX ? UINT32_MAX : (uint32_t)total;
+	return export_to(layer, target, &copy);
+}
+
+static void export_held(struct nlmon_event *event, uint32_t weight, void *arg)
+{
+	struct sample_export *out = arg;
+	
+	if (export_weighted(out->layer, out->target, event, weight))
+		out->exported++;
+	else
+		out->failed++;
+}
+
+/* Sample an event and write it if kept, returns false if the exporter failed */
+static bool export_sampled(struct export_layer *layer, enum export_target target,
+                           struct nlmon_event *event, struct sample_export *held,
+                           bool *kept)
+{
+	struct event_sampler *sampler = layer->samplers[target];
+	uint32_t weight = 1;
+	
+	if (sampler)
+		weight = event_sampler_offer(sampler, event, now_ns(), export_held, held);
+	*kept = weight > 0;
+	return weight == 0 || export_weighted(layer, target, event, weight);
+}
+
+/* Flush the output of one exporter */
+static bool flush_target(struct export_layer *layer, enum export_target target)
+{
+	switch (target) {
+	case EXPORT_TARGET_PCAP:
+		return pcap_exporter_flush(layer->pcap);
+	case EXPORT_TARGET_JSON:
+		return json_exporter_flush(layer->json);
+	case EXPORT_TARGET_SYSLOG:
+		return syslog_forwarder_flush(layer->syslog);
+	case EXPORT_TARGET_LOG:
+		return log_rotator_flush(layer->log_rotator);
+	case EXPORT_TARGET_BINARY:
+		return binary_exporter_flush(layer->binary);
+	case EXPORT_TARGET_STREAM:
+		return event_stream_flush(layer->stream);
+	case EXPORT_TARGET_OTLP:
+		return otlp_exporter_flush(layer->otlp);
+	default:
+		return true;
+	}
+}
+
+/* Whether an exporter has work to do while no events come */
+static bool target_timed(enum export_target target)
+{
+	return target == EXPORT_TARGET_OTLP;
+}
+
+static void tick_target(struct export_layer *layer, enum export_target target)
+{
+	if (target == EXPORT_TARGET_OTLP)
+		otlp_exporter_tick(layer->otlp);
+}
+
+/* Hand on the reservoir events of intervals that ended, or all with drain */
+static void sampler_release(struct export_queue *queue, bool drain, struct sample_export *held)
+{
+	struct event_sampler *sampler = queue->layer->samplers[queue->target];
+	
+	if (!sampler)
+		return;
+	if (drain)
+		event_sampler_drain(sampler, export_held, held);
+	else
+		event_sampler_tick(sampler, now_ns(), export_held, held);
+}
+
+/* Count the reservoir events written and what sampling left out, lock held */
+static void sampler_account(struct export_queue *queue, const struct sample_export *held)
+{
+	struct event_sampler *sampler = queue->layer->samplers[queue->target];
+	struct event_sampler_stats stats;
+	
+	queue->exported += held->exported;
+	queue->failed += held->failed;
+	if (!sampler)
+		return;
+	
+	event_sampler_get_stats(sampler, &stats);
+	queue->sampled = stats.seen - stats.kept - stats.held;
+	queue->held = stats.held;
+}
+
+/* Wait for work up to TICK_MS, not_empty runs on CLOCK_MONOTONIC */
+static int wait_timed(struct export_queue *queue)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_nsec += TICK_MS * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	return pthread_cond_timedwait(&queue->not_empty, &queue->lock, &ts);
+}
+
+/* Worker thread, exports queued events in chunks */
+static void *export_worker(void *arg)
+{
+	struct export_queue *queue = arg;
+	struct export_entry chunk[WORKER_CHUNK];
+	bool timed = target_timed(queue->target) ||
+	             event_sampler_holds(queue->layer->samplers[queue->target]);
+	
+	nlmon_heartbeat_register(target_names[queue->target], NULL, NULL);
+	pthread_mutex_lock(&queue->lock);
+	
+	for (;;) {
+		struct sample_export held = { .layer = queue->layer, .target = queue->target };
+		uint64_t done_pos, ticket = 0, exported = 0, failed = 0, lag_max_us = 0;
+		bool flush, flush_ok = true;
+		size_t n;
+		
+		while (queue->count == 0 && queue->flush_requested == queue->flush_done &&
+		       queue->running) {
+			if (!timed) {
+				pthread_cond_wait(&queue->not_empty, &queue->lock);
+			} else if (wait_timed(queue) == ETIMEDOUT) {
+				struct sample_export ticked = held;
+				
+				pthread_mutex_unlock(&queue->lock);
+				nlmon_heartbeat_enter("export-tick");
+				sampler_release(queue, false, &ticked);
+				tick_target(queue->layer, queue->target);
+				nlmon_heartbeat_leave(NULL);
+				pthread_mutex_lock(&queue->lock);
+				sampler_account(queue, &ticked);
+			}
+		}
+		
+		/* Stop once everything queued before shutdown is exported, held events too */
+		if (queue->count == 0 && queue->flush_requested == queue->flush_done) {
+			pthread_mutex_unlock(&queue->lock);
+			sampler_release(queue, true, &held);
+			pthread_mutex_lock(&queue->lock);
+			sampler_account(queue, &held);
+			break;
+		}
+		
+		n = queue->count < WORKER_CHUNK ? queue->count : WORKER_CHUNK;
+		for (size_t i = 0; i < n; i++) {
+			chunk[i] = queue->entries[queue->head];
+			queue->head = (queue->head + 1) % queue->size;
+		}
+		queue->count -= n;
+		done_pos = queue->tail_pos - queue->count;
+		flush = queue->flush_requested > queue->flush_done && queue->flush_pos <= done_pos;
+		if (flush)
+			ticket = queue->flush_requested;
+		pthread_cond_broadcast(&queue->not_full);
+		
+		pthread_mutex_unlock(&queue->lock);
+		nlmon_heartbeat_enter("export");
+		
+		for (size_t i = 0; i < n; i++) {
+			uint64_t lag_us;
+			bool kept;
+			
+			if (!export_sampled(queue->layer, queue->target, chunk[i].event, &held, &kept)) {
+				failed++;
+			} else if (kept) {
+				nlmon_trace_report(&chunk[i].trace, NLMON_TRACE_EXPORT);
+				exported++;
+			}
+			nlmon_event_put(chunk[i].event);
+			
+			lag_us = (now_ns() - chunk[i].queued_ns) / 1000;
+			if (lag_us > lag_max_us)
+				lag_max_us = lag_us;
+		}
+		
+		/* A flush takes the events held by sampling along */
+		if (flush) {
+			sampler_release(queue, true, &held);
+			flush_ok = flush_target(queue->layer, queue->target);
+		} else if (queue->target == EXPORT_TARGET_SYSLOG) {
+			syslog_forwarder_flush(queue->layer->syslog);      /* Batches end with the chunk */
+		}
+		
+		nlmon_heartbeat_leave(NULL);
+		pthread_mutex_lock(&queue->lock);
+		
+		queue->exported += exported;
+		queue->failed += failed;
+		sampler_account(queue, &held);
+		if (lag_max_us > queue->lag_max_us)
+			queue->lag_max_us = lag_max_us;
+		
+		if (flush) {
+			queue->flush_done = ticket;
+			queue->flush_ok = flush_ok;
+			pthread_cond_broadcast(&queue->flushed);
+		}
+	}
+	
+	pthread_mutex_unlock(&queue->lock);
+	nlmon_heartbeat_unregister();
+	
+	return NULL;
+}
+
+static struct export_queue *export_queue_create(struct export_layer *layer,
+                                                enum export_target target,
+                                                const struct export_queue_config *config)
+{
+	struct export_queue *queue;
+	pthread_condattr_t attr;
+	
+	queue = calloc(1, sizeof(*queue));
+	if (!queue)
+		return NULL;
+	
+	queue->layer = layer;
+	queue->target = target;
+	queue->overflow = config->overflow;
+	queue->size = config->size > 0 ? config->size : DEFAULT_QUEUE_SIZE;
+	queue->flush_ok = true;
+	queue->running = true;
+	
+	queue->entries = calloc(queue->size, sizeof(*queue->entries));
+	if (!queue->entries)
+		goto fail_queue;
+	
+	if (pthread_mutex_init(&queue->lock, NULL) != 0)
+		goto fail_entries;
+	if (pthread_condattr_init(&attr) != 0)
+		goto fail_lock;
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	if (pthread_cond_init(&queue->not_empty, &attr) != 0) {
+		pthread_condattr_destroy(&attr);
+		goto fail_lock;
+	}
+	pthread_condattr_destroy(&attr);
+	if (pthread_cond_init(&queue->not_full, NULL) != 0)
+		goto fail_not_empty;
+	if (pthread_cond_init(&queue->flushed, NULL) != 0)
+		goto fail_not_full;
+	if (pthread_create(&queue->worker, NULL, export_worker, queue) != 0)
+		goto fail_flushed;
+	
+	thread_affinity_apply(queue->worker, NULL, -1, target_names[target]);
+	
+	return queue;
+	
+fail_flushed:
+	pthread_cond_destroy(&queue->flushed);
+fail_not_full:
+	pthread_cond_destroy(&queue->not_full);
+fail_not_empty:
+	pthread_cond_destroy(&queue->not_empty);
+fail_lock:
+	pthread_mutex_destroy(&queue->lock);
+fail_entries:
+	free(queue->entries);
+fail_queue:
+	free(queue);
+	return NULL;
+}
+
+/* Stop the worker after it exported what is queued */
+static void export_queue_destroy(struct export_queue *queue)
+{
+	if (!queue)
+		return;
+	
+	pthread_mutex_lock(&queue->lock);
+	queue->running = false;
+	pthread_cond_signal(&queue->not_empty);
+	pthread_cond_broadcast(&queue->not_full);
+	pthread_mutex_unlock(&queue->lock);
+	
+	pthread_join(queue->worker, NULL);
+	
+	pthread_cond_destroy(&queue->flushed);
+	pthread_cond_destroy(&queue->not_full);
+	pthread_cond_destroy(&queue->not_empty);
+	pthread_mutex_destroy(&queue->lock);
+	free(queue->entries);
+	free(queue);
+}
+
+/* Queue an event reference, consumed either way */
+static bool export_queue_push(struct export_queue *queue, struct nlmon_event *event,
+                              const struct nlmon_event_trace *trace)
+{
+	struct nlmon_event *dropped = NULL;
+	
+	pthread_mutex_lock(&queue->lock);
+	
+	if (queue->count == queue->size) {
+		switch (queue->overflow) {
+		case EXPORT_OVERFLOW_BLOCK:
+			while (queue->count == queue->size && queue->running)
+				pthread_cond_wait(&queue->not_full, &queue->lock);
+			break;
+		case EXPORT_OVERFLOW_DROP_OLDEST:
+			dropped = queue->entries[queue->head].event;
+			queue->head = (queue->head + 1) % queue->size;
+			queue->count--;
+			queue->dropped++;
+			break;
+		default:
+			break;
+		}
+	}
+	
+	if (queue->count == queue->size || !queue->running) {
+		queue->dropped++;
+		pthread_mutex_unlock(&queue->lock);
+		nlmon_event_put(event);
+		return false;
+	}
+	
+	queue->entries[(queue->head + queue->count) % queue->size] = (struct export_entry){
+		.event = event,
+		.queued_ns = now_ns(),
+		.trace = *trace,
+	};
+	queue->count++;
+	queue->tail_pos++;
+	queue->queued++;
+	pthread_cond_signal(&queue->not_empty);
+	
+	pthread_mutex_unlock(&queue->lock);
+	
+	/* Released outside the lock, it may be the last reference */
+	if (dropped)
+		nlmon_event_put(dropped);
+	
+	return true;
+}
+
 struct export_layer *export_layer_create(struct export_layer_config *config)
 {
 	struct export_layer *layer;
@@ -25,8 +653,9 @@ struct export_layer *export_layer_create(struct export_layer_config *config)
 	
 	/* Initialize PCAP exporter */
 	if (config->enable_pcap && config->pcap_filename) {
-		layer->pcap = pcap_exporter_create(config->pcap_filename,
-		                                   &config->pcap_policy);
+		layer->pcap = pcap_exporter_create_with_options(config->pcap_filename,
+		                                                &config->pcap_policy,
+		                                                &config->pcap_options);
 		if (!layer->pcap) {
 			export_layer_destroy(layer);
 			return NULL;
@@ -39,7 +668,37 @@ struct export_layer *export_layer_create(struct export_layer_config *config)
 		                                   config->json_format,
 		                                   config->json_streaming,
 		                                   config->json_filename ? &config->json_policy : NULL);
-		if (!layer->json) {
+		if (!layer->json || (config->json_io &&
+		                     !json_exporter_set_io_service(layer->json, config->json_io))) {
+			export_layer_destroy(layer);
+			return NULL;
+		}
+	}
+	
+	/* Initialize binary exporter */
+	if (config->enable_binary && config->binary_filename) {
+		layer->binary = binary_exporter_create(config->binary_filename,
+		                                       &config->binary_options);
+		if (!layer->binary) {
+			export_layer_destroy(layer);
+			return NULL;
+		}
+	}
+	
+	/* Initialize event bus */
+	if (config->enable_bus) {
+		layer->bus = event_bus_create(config->bus_name ? config->bus_name : EVENT_BUS_DEFAULT_NAME,
+		                              &config->bus_options);
+		if (!layer->bus) {
+			export_layer_destroy(layer);
+			return NULL;
+		}
+	}
+	
+	/* Initialize stream exporter */
+	if (config->enable_stream) {
+		layer->stream = event_stream_create(&config->stream_config);
+		if (!layer->stream) {
 			export_layer_destroy(layer);
 			return NULL;
 		}
@@ -53,6 +712,25 @@ struct export_layer *export_layer_create(struct export_layer_config *config)
 			export_layer_destroy(layer);
 			return NULL;
 		}
+		prometheus_exporter_set_affinity(layer->prometheus, config->prometheus_cpus);
+		if (config->prometheus_cache_ms)
+			prometheus_exporter_set_cache_interval(layer->prometheus,
+			                                       config->prometheus_cache_ms);
+		prometheus_exporter_set_cardinality(layer->prometheus, NULL,
+		                                    &config->prometheus_cardinality);
+	}
+	
+	/* Initialize OTLP exporter, after the Prometheus one it reads */
+	if (config->enable_otlp) {
+		struct otlp_config otlp = config->otlp_config;
+		
+		if (!otlp.prometheus)
+			otlp.prometheus = layer->prometheus;
+		layer->otlp = otlp_exporter_create(&otlp);
+		if (!layer->otlp) {
+			export_layer_destroy(layer);
+			return NULL;
+		}
 	}
 	
 	/* Initialize syslog forwarder */
@@ -74,6 +752,32 @@ struct export_layer *export_layer_create(struct export_layer_config *config)
 		}
 	}
 	
+	/* Samplers first, the workers pick theirs up on start */
+	for (int target = 0; target < EXPORT_TARGET_COUNT; target++) {
+		if (!target_enabled(layer, target) ||
+		    !event_sampler_config_active(&config->sampling[target]))
+			continue;
+		
+		layer->samplers[target] = event_sampler_create(&config->sampling[target]);
+		if (!layer->samplers[target]) {
+			export_layer_destroy(layer);
+			return NULL;
+		}
+	}
+	
+	/* Start a queue per enabled exporter */
+	layer->sync_export = config->sync_export;
+	for (int target = 0; target < EXPORT_TARGET_COUNT && !layer->sync_export; target++) {
+		if (!target_enabled(layer, target))
+			continue;
+		
+		layer->queues[target] = export_queue_create(layer, target, &config->queues[target]);
+		if (!layer->queues[target]) {
+			export_layer_destroy(layer);
+			return NULL;
+		}
+	}
+	
 	return layer;
 }
 
@@ -82,10 +786,31 @@ void export_layer_destroy(struct export_layer *layer)
 	if (!layer)
 		return;
 	
+	/* Workers finish their queues before the exporters go */
+	for (int target = 0; target < EXPORT_TARGET_COUNT; target++)
+		export_queue_destroy(layer->queues[target]);
+	
+	/* Without workers the events held by sampling are written here */
+	for (int target = 0; target < EXPORT_TARGET_COUNT; target++) {
+		struct sample_export held = { .layer = layer, .target = target };
+		
+		if (layer->sync_export && layer->samplers[target])
+			event_sampler_drain(layer->samplers[target], export_held, &held);
+		event_sampler_destroy(layer->samplers[target]);
+	}
+	
 	if (layer->pcap)
 		pcap_exporter_destroy(layer->pcap);
 	if (layer->json)
 		json_exporter_destroy(layer->json);
+	if (layer->binary)
+		binary_exporter_destroy(layer->binary);
+	if (layer->bus)
+		event_bus_destroy(layer->bus);
+	if (layer->stream)
+		event_stream_destroy(layer->stream);
+	if (layer->otlp)
+		otlp_exporter_destroy(layer->otlp);
 	if (layer->prometheus)
 		prometheus_exporter_destroy(layer->prometheus);
 	if (layer->syslog)
@@ -106,6 +831,26 @@ struct json_exporter *export_layer_get_json(struct export_layer *layer)
 	return layer ? layer->json : NULL;
 }
 
+struct binary_exporter *export_layer_get_binary(struct export_layer *layer)
+{
+	return layer ? layer->binary : NULL;
+}
+
+struct event_bus *export_layer_get_bus(struct export_layer *layer)
+{
+	return layer ? layer->bus : NULL;
+}
+
+struct event_stream *export_layer_get_stream(struct export_layer *layer)
+{
+	return layer ? layer->stream : NULL;
+}
+
+struct otlp_exporter *export_layer_get_otlp(struct export_layer *layer)
+{
+	return layer ? layer->otlp : NULL;
+}
+
 struct prometheus_exporter *export_layer_get_prometheus(struct export_layer *layer)
 {
 	return layer ? layer->prometheus : NULL;
@@ -121,21 +866,156 @@ struct log_rotator *export_layer_get_log_rotator(struct export_layer *layer)
 	return layer ? layer->log_rotator : NULL;
 }
 
+bool export_layer_export_event(struct export_layer *layer, struct nlmon_event *event)
+{
+	struct nlmon_event *ref;
+	bool success = true;
+	
+	if (!layer || !event)
+		return false;
+	
+	if (layer->sync_export) {
+		for (int target = 0; target < EXPORT_TARGET_COUNT; target++) {
+			struct sample_export held = { .layer = layer, .target = target };
+			bool kept;
+			
+			if (target_enabled(layer, target) &&
+			    (!export_sampled(layer, target, event, &held, &kept) || held.failed > 0))
+				success = false;
+		}
+		nlmon_trace_stamp(&event->trace, NLMON_TRACE_EXPORT);
+		return success;
+	}
+	
+	/* One shared copy at most, each queue takes a reference to it */
+	ref = nlmon_event_share(event);
+	if (!ref)
+		return false;
+	
+	for (int target = 0; target < EXPORT_TARGET_COUNT; target++) {
+		struct nlmon_event *queued;
+		
+		if (!layer->queues[target])
+			continue;
+		
+		queued = nlmon_event_share(ref);
+		if (!queued || !export_queue_push(layer->queues[target], queued, &event->trace))
+			success = false;
+	}
+	
+	nlmon_event_put(ref);
+	
+	return success;
+}
+
 bool export_layer_flush_all(struct export_layer *layer)
 {
+	uint64_t tickets[EXPORT_TARGET_COUNT] = {0};
 	bool success = true;
 	
 	if (!layer)
 		return false;
 	
-	if (layer->pcap && !pcap_exporter_flush(layer->pcap))
-		success = false;
+	if (layer->sync_export) {
+		for (int target = 0; target < EXPORT_TARGET_COUNT; target++) {
+			struct sample_export held = { .layer = layer, .target = target };
+			
+			if (!target_enabled(layer, target))
+				continue;
+			if (layer->samplers[target])
+				event_sampler_drain(layer->samplers[target], export_held, &held);
+			if (held.failed > 0 || !flush_target(layer, target))
+				success = false;
+		}
+		return success;
+	}
 	
-	if (layer->json && !json_exporter_flush(layer->json))
-		success = false;
+	/* Ask every worker first, so the queues drain in parallel */
+	for (int target = 0; target < EXPORT_TARGET_COUNT; target++) {
+		struct export_queue *queue = layer->queues[target];
+		
+		if (!queue)
+			continue;
+		
+		pthread_mutex_lock(&queue->lock);
+		tickets[target] = ++queue->flush_requested;
+		queue->flush_pos = queue->tail_pos;
+		pthread_cond_signal(&queue->not_empty);
+		pthread_mutex_unlock(&queue->lock);
+	}
 	
-	if (layer->log_rotator && !log_rotator_flush(layer->log_rotator))
-		success = false;
+	for (int target = 0; target < EXPORT_TARGET_COUNT; target++) {
+		struct export_queue *queue = layer->queues[target];
+		
+		if (!queue)
+			continue;
+		
+		pthread_mutex_lock(&queue->lock);
+		while (queue->flush_done < tickets[target])
+			pthread_cond_wait(&queue->flushed, &queue->lock);
+		if (!queue->flush_ok)
+			success = false;
+		pthread_mutex_unlock(&queue->lock);
+	}
 	
 	return success;
 }
+
+bool export_layer_get_queue_stats(struct export_layer *layer, enum export_target target,
+                                  struct export_queue_stats *stats)
+{
+	struct export_queue *queue;
+	
+	if (!layer || !stats || target < 0 || target >= EXPORT_TARGET_COUNT)
+		return false;
+	
+	queue = layer->queues[target];
+	if (!queue)
+		return false;
+	
+	pthread_mutex_lock(&queue->lock);
+	
+	stats->queued = queue->queued;
+	stats->exported = queue->exported;
+	stats->failed = queue->failed;
+	stats->dropped = queue->dropped;
+	stats->sampled = queue->sampled;
+	stats->held = queue->held;
+	stats->queue_depth = queue->count;
+	stats->lag_us = queue->count ?
+	                (now_ns() - queue->entries[queue->head].queued_ns) / 1000 : 0;
+	stats->lag_max_us = queue->lag_max_us;
+	
+	pthread_mutex_unlock(&queue->lock);
+	
+	return true;
+}
+
+void export_layer_collect_stats(struct nlmon_stats_snapshot *snapshot, void *ctx)
+{
+	struct export_layer *layer = ctx;
+	struct export_queue_stats stats;
+	int target;
+	
+	_Static_assert(EXPORT_TARGET_COUNT <= STATS_BUS_MAX_EXPORTS, "stats bus export slots");
+	
+	if (!layer)
+		return;
+	
+	for (target = 0; target < EXPORT_TARGET_COUNT; target++) {
+		struct stats_export *out = &snapshot->exports[target];
+		
+		if (!export_layer_get_queue_stats(layer, target, &stats))
+			continue;
+		out->queued = stats.queued;
+		out->exported = stats.exported;
+		out->failed = stats.failed;
+		out->dropped = stats.dropped;
+		out->sampled = stats.sampled;
+		out->queue_depth = stats.queue_depth;
+		out->lag_us = stats.lag_us;
+		out->lag_max_us = stats.lag_max_us;
+		snapshot->exports_enabled |= 1u << target;
+	}
+	snapshot->have |= STATS_HAVE_EXPORT;
+}
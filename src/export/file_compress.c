@@ -0,0 +1,436 @@
+/* file_compress.c - Background gzip compression of rotated files
+ *
+ * Files are compressed one at a time. The thread that starts a file maps
+ * it and cuts it into chunks; every thread then takes the next chunk and
+ * deflates it into its own gzip member without the lock. The thread that
+ * finishes the last chunk takes the file off the compressor, so the
+ * others can start on the next one, and writes the members out in order.
+ */
+
+#include "file_compress.h"
+#include "thread_affinity.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define FILE_COMPRESS_MAX_THREADS 16
+
+/* A compressed chunk */
+struct compress_member {
+	unsigned char *data;
+	size_t len;
+};
+
+/* A queued or running file */
+struct compress_job {
+	struct compress_job *next;
+	char *path;
+	
+	/* Set up by the thread that starts the job */
+	const unsigned char *map;
+	size_t size;
+	size_t chunks;
+	size_t next_chunk;
+	size_t done_chunks;
+	bool failed;
+	struct compress_member *members;
+};
+
+struct file_compressor {
+	struct file_compress_config config;
+	
+	pthread_mutex_t lock;
+	pthread_cond_t work;            /* A job was queued or a chunk is free */
+	pthread_cond_t idle;            /* pending reached zero */
+	struct compress_job *head;
+	struct compress_job *tail;
+	struct compress_job *current;   /* Job whose chunks are being compressed */
+	bool starting;                  /* A thread is setting up the next job */
+	bool stopping;
+	
+	pthread_t threads[FILE_COMPRESS_MAX_THREADS];
+	int thread_count;
+	
+	/* Statistics, under lock */
+	uint64_t files;
+	uint64_t failed;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t pending;
+};
+
+static void free_job(struct compress_job *job)
+{
+	size_t i;
+	
+	if (job->members) {
+		for (i = 0; i < job->chunks; i++)
+			free(job->members[i].data);
+		free(job->members);
+	}
+	
+	if (job->map)
+		munmap((void *)job->map, job->size);
+	
+	free(job->path);
+	free(job);
+}
+
+/* Map the file and size the member table, false if it cannot be read */
+static bool start_job(struct file_compressor *fc, struct compress_job *job)
+{
+	struct stat st;
+	void *map;
+	int fd;
+	
+	fd = open(job->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return false;
+	}
+	
+	job->size = st.st_size;
+	if (job->size > 0) {
+		map = mmap(NULL, job->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			close(fd);
+			return false;
+		}
+		madvise(map, job->size, MADV_SEQUENTIAL);
+		job->map = map;
+	}
+	close(fd);
+	
+	/* An empty file still gets one (empty) member */
+	job->chunks = job->size ? (job->size + fc->config.chunk_size - 1) / fc->config.chunk_size : 1;
+	job->members = calloc(job->chunks, sizeof(*job->members));
+	return job->members != NULL;
+}
+
+/* Deflate one chunk into a complete gzip member */
+static bool compress_chunk(struct file_compressor *fc, struct compress_job *job, size_t chunk)
+{
+	struct compress_member *member = &job->members[chunk];
+	size_t offset = chunk * fc->config.chunk_size;
+	size_t len = job->size - offset < fc->config.chunk_size ? job->size - offset : fc->config.chunk_size;
+	unsigned char *shrunk;
+	size_t bound;
+	z_stream zs;
+	int ret;
+	
+	memset(&zs, 0, sizeof(zs));
+	
+	/* 16 + 15 window bits asks for a gzip header and trailer */
+	if (deflateInit2(&zs, fc->config.level, Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return false;
+	
+	bound = deflateBound(&zs, len);
+	member->data = malloc(bound);
+	if (!member->data) {
+		deflateEnd(&zs);
+		return false;
+	}
+	
+	zs.next_in = (unsigned char *)(job->size ? job->map + offset : NULL);
+	zs.avail_in = len;
+	zs.next_out = member->data;
+	zs.avail_out = bound;
+	ret = deflate(&zs, Z_FINISH);
+	member->len = zs.total_out;
+	deflateEnd(&zs);
+	
+	/* Hold on to the compressed size only until the file is written */
+	shrunk = realloc(member->data, member->len ? member->len : 1);
+	if (shrunk)
+		member->data = shrunk;
+	
+	return ret == Z_STREAM_END;
+}
+
+/* Write the members out through a temporary name, then drop the source */
+static bool finish_job(struct compress_job *job, uint64_t *bytes_out)
+{
+	size_t len = strlen(job->path);
+	char *gz_name, *tmp_name;
+	bool ok = false;
+	size_t i;
+	int fd;
+	
+	*bytes_out = 0;
+	
+	gz_name = malloc(len + 4);
+	tmp_name = malloc(len + 8);
+	if (!gz_name || !tmp_name)
+		goto out;
+	
+	snprintf(gz_name, len + 4, "%s.gz", job->path);
+	snprintf(tmp_name, len + 8, "%s.gz.tmp", job->path);
+	
+	fd = open(tmp_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		goto out;
+	
+	for (i = 0; i < job->chunks; i++) {
+		const unsigned char *p = job->members[i].data;
+		size_t left = job->members[i].len;
+		
+		while (left > 0) {
+			ssize_t n = write(fd, p, left);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				close(fd);
+				unlink(tmp_name);
+				goto out;
+			}
+			p += n;
+			left -= n;
+		}
+		*bytes_out += job->members[i].len;
+	}
+	
+	if (close(fd) < 0 || rename(tmp_name, gz_name) < 0) {
+		unlink(tmp_name);
+		goto out;
+	}
+	
+	unlink(job->path);
+	ok = true;
+	
+out:
+	free(gz_name);
+	free(tmp_name);
+	return ok;
+}
+
+/* Count a finished job, called with the lock held */
+static void job_done(struct file_compressor *fc, struct compress_job *job,
+                     bool ok, uint64_t bytes_out)
+{
+	if (ok) {
+		fc->files++;
+		fc->bytes_in += job->size;
+		fc->bytes_out += bytes_out;
+	} else {
+		fc->failed++;
+	}
+	
+	if (--fc->pending == 0)
+		pthread_cond_broadcast(&fc->idle);
+}
+
+static void *compress_thread(void *arg)
+{
+	struct file_compressor *fc = arg;
+	struct compress_job *job;
+	uint64_t bytes_out;
+	size_t chunk;
+	bool ok;
+	
+	pthread_mutex_lock(&fc->lock);
+	
+	for (;;) {
+		/* One thread at a time sets up the next file */
+		if (!fc->current && !fc->starting && fc->head) {
+			job = fc->head;
+			fc->head = job->next;
+			if (!fc->head)
+				fc->tail = NULL;
+			fc->starting = true;
+			
+			pthread_mutex_unlock(&fc->lock);
+			ok = start_job(fc, job);
+			pthread_mutex_lock(&fc->lock);
+			
+			fc->starting = false;
+			pthread_cond_broadcast(&fc->work);
+			if (!ok) {
+				job_done(fc, job, false, 0);
+				pthread_mutex_unlock(&fc->lock);
+				free_job(job);
+				pthread_mutex_lock(&fc->lock);
+				continue;
+			}
+			fc->current = job;
+		}
+		
+		job = fc->current;
+		if (!job || job->next_chunk == job->chunks) {
+			if (fc->stopping && !fc->head && !fc->current && !fc->starting)
+				break;
+			pthread_cond_wait(&fc->work, &fc->lock);
+			continue;
+		}
+		
+		chunk = job->next_chunk++;
+		pthread_mutex_unlock(&fc->lock);
+		ok = compress_chunk(fc, job, chunk);
+		pthread_mutex_lock(&fc->lock);
+		
+		if (!ok)
+			job->failed = true;
+		if (++job->done_chunks < job->chunks)
+			continue;
+		
+		/* Last chunk: let the other threads move on, then write */
+		fc->current = NULL;
+		pthread_cond_broadcast(&fc->work);
+		pthread_mutex_unlock(&fc->lock);
+		
+		ok = !job->failed && finish_job(job, &bytes_out);
+		
+		pthread_mutex_lock(&fc->lock);
+		job_done(fc, job, ok, bytes_out);
+		pthread_mutex_unlock(&fc->lock);
+		free_job(job);
+		pthread_mutex_lock(&fc->lock);
+	}
+	
+	pthread_mutex_unlock(&fc->lock);
+	return NULL;
+}
+
+struct file_compressor *file_compressor_create(const struct file_compress_config *config)
+{
+	struct file_compressor *fc;
+	char name[16];
+	int i;
+	
+	fc = calloc(1, sizeof(*fc));
+	if (!fc)
+		return NULL;
+	
+	if (config)
+		fc->config = *config;
+	if (fc->config.level <= 0 || fc->config.level > 9)
+		fc->config.level = Z_DEFAULT_COMPRESSION;
+	if (fc->config.threads <= 0)
+		fc->config.threads = 1;
+	if (fc->config.threads > FILE_COMPRESS_MAX_THREADS)
+		fc->config.threads = FILE_COMPRESS_MAX_THREADS;
+	if (fc->config.chunk_size == 0)
+		fc->config.chunk_size = FILE_COMPRESS_CHUNK_SIZE;
+	
+	if (pthread_mutex_init(&fc->lock, NULL) != 0)
+		goto err_free;
+	if (pthread_cond_init(&fc->work, NULL) != 0)
+		goto err_lock;
+	if (pthread_cond_init(&fc->idle, NULL) != 0)
+		goto err_work;
+	
+	for (i = 0; i < fc->config.threads; i++) {
+		if (pthread_create(&fc->threads[i], NULL, compress_thread, fc) != 0)
+			goto err_threads;
+		snprintf(name, sizeof(name), "gzip-%d", i);
+		thread_affinity_apply(fc->threads[i], NULL, -1, name);
+		fc->thread_count++;
+	}
+	
+	return fc;
+	
+err_threads:
+	pthread_mutex_lock(&fc->lock);
+	fc->stopping = true;
+	pthread_cond_broadcast(&fc->work);
+	pthread_mutex_unlock(&fc->lock);
+	for (i = 0; i < fc->thread_count; i++)
+		pthread_join(fc->threads[i], NULL);
+	pthread_cond_destroy(&fc->idle);
+err_work:
+	pthread_cond_destroy(&fc->work);
+err_lock:
+	pthread_mutex_destroy(&fc->lock);
+err_free:
+	free(fc);
+	return NULL;
+}
+
+void file_compressor_destroy(struct file_compressor *fc)
+{
+	int i;
+	
+	if (!fc)
+		return;
+	
+	/* Threads drain the queue before they exit */
+	pthread_mutex_lock(&fc->lock);
+	fc->stopping = true;
+	pthread_cond_broadcast(&fc->work);
+	pthread_mutex_unlock(&fc->lock);
+	
+	for (i = 0; i < fc->thread_count; i++)
+		pthread_join(fc->threads[i], NULL);
+	
+	pthread_cond_destroy(&fc->idle);
+	pthread_cond_destroy(&fc->work);
+	pthread_mutex_destroy(&fc->lock);
+	free(fc);
+}
+
+bool file_compressor_submit(struct file_compressor *fc, const char *path)
+{
+	struct compress_job *job;
+	
+	if (!fc || !path)
+		return false;
+	
+	job = calloc(1, sizeof(*job));
+	if (!job)
+		return false;
+	
+	job->path = strdup(path);
+	if (!job->path) {
+		free(job);
+		return false;
+	}
+	
+	pthread_mutex_lock(&fc->lock);
+	if (fc->tail)
+		fc->tail->next = job;
+	else
+		fc->head = job;
+	fc->tail = job;
+	fc->pending++;
+	pthread_cond_broadcast(&fc->work);
+	pthread_mutex_unlock(&fc->lock);
+	
+	return true;
+}
+
+void file_compressor_wait(struct file_compressor *fc)
+{
+	if (!fc)
+		return;
+	
+	pthread_mutex_lock(&fc->lock);
+	while (fc->pending > 0)
+		pthread_cond_wait(&fc->idle, &fc->lock);
+	pthread_mutex_unlock(&fc->lock);
+}
+
+bool file_compressor_get_stats(struct file_compressor *fc,
+                               struct file_compress_stats *stats)
+{
+	if (!fc || !stats)
+		return false;
+	
+	pthread_mutex_lock(&fc->lock);
+	stats->files = fc->files;
+	stats->failed = fc->failed;
+	stats->bytes_in = fc->bytes_in;
+	stats->bytes_out = fc->bytes_out;
+	stats->pending = fc->pending;
+	pthread_mutex_unlock(&fc->lock);
+	
+	return true;
+}
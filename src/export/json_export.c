@@ -1,6 +1,12 @@
 /* json_export.c - JSON export format with rotation support */
 
 #include "json_export.h"
+#include "json_buf.h"
+#include "file_compress.h"
+#include "io_service.h"
+#include "correlation_engine.h"
+#include <fcntl.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -8,16 +14,28 @@
 #include <errno.h>
 #include <unistd.h>
 
+/* Pending output is written out once it reaches this size */
+#define JSON_EXPORT_BATCH_BYTES (64 * 1024)
+
 struct json_exporter {
 	char *filename;
-	FILE *fp;
+	int fd;
 	enum json_format format;
 	bool streaming;
-	bool owns_fp;
+	bool owns_fd;
 	struct json_rotation_policy policy;
 	bool has_policy;
+	struct file_compressor *compressor;  /* Set when rotated files are compressed */
 	bool first_event;
 	
+	/* Serialized events not yet written */
+	struct json_buf out;
+	
+	/* Writes handed to an I/O service, at explicit offsets */
+	struct io_service *io;
+	uint64_t file_offset;
+	atomic_bool io_failed;
+	
 	/* Statistics */
 	uint64_t events_written;
 	uint64_t bytes_written;
@@ -25,45 +43,63 @@ struct json_exporter {
 	uint32_t rotations;
 };
 
-static void json_escape_string(FILE *fp, const char *str)
+static void io_done(void *ctx, int result)
 {
-	if (!str) {
-		fprintf(fp, "null");
-		return;
+	struct json_exporter *exporter = ctx;
+	
+	if (result < 0)
+		atomic_store(&exporter->io_failed, true);
+}
+
+/* Wait for the I/O service, false if one of the writes failed */
+static bool io_settle(struct json_exporter *exporter)
+{
+	if (!exporter->io)
+		return true;
+	
+	io_service_wait(exporter->io);
+	return !atomic_exchange(&exporter->io_failed, false);
+}
+
+/* Write all pending output with one write() in the common case */
+static bool write_pending(struct json_exporter *exporter)
+{
+	size_t done = 0;
+	bool result;
+	
+	if (exporter->out.failed) {
+		json_buf_reset(&exporter->out);
+		return false;
 	}
 	
-	fputc('"', fp);
-	while (*str) {
-		switch (*str) {
-		case '"':  fprintf(fp, "\\\""); break;
-		case '\\': fprintf(fp, "\\\\"); break;
-		case '\b': fprintf(fp, "\\b"); break;
-		case '\f': fprintf(fp, "\\f"); break;
-		case '\n': fprintf(fp, "\\n"); break;
-		case '\r': fprintf(fp, "\\r"); break;
-		case '\t': fprintf(fp, "\\t"); break;
-		default:
-			if ((unsigned char)*str < 32) {
-				fprintf(fp, "\\u%04x", (unsigned char)*str);
-			} else {
-				fputc(*str, fp);
-			}
-			break;
+	if (exporter->io && exporter->owns_fd) {
+		result = io_service_write_data(exporter->io, exporter->fd, exporter->file_offset,
+		                               exporter->out.data, exporter->out.len, 0,
+		                               io_done, exporter);
+		exporter->file_offset += exporter->out.len;
+		json_buf_reset(&exporter->out);
+		return result;
+	}
+	
+	while (done < exporter->out.len) {
+		ssize_t n = write(exporter->fd, exporter->out.data + done,
+		                  exporter->out.len - done);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			json_buf_reset(&exporter->out);
+			return false;
 		}
-		str++;
+		done += n;
 	}
-	fputc('"', fp);
+	
+	json_buf_reset(&exporter->out);
+	return true;
 }
 
-static bool compress_file(const char *filename)
+static int open_output(const char *filename)
 {
-	char cmd[1024];
-	int ret;
-	
-	snprintf(cmd, sizeof(cmd), "gzip -f '%s' 2>/dev/null", filename);
-	ret = system(cmd);
-	
-	return ret == 0;
+	return open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
 }
 
 static char *generate_rotated_filename(const char *base, uint32_t rotation)
@@ -85,15 +121,19 @@ static bool rotate_files(struct json_exporter *exporter)
 	uint32_t i;
 	
 	/* Close array if not streaming */
-	if (!exporter->streaming && exporter->fp) {
-		fprintf(exporter->fp, "\n]\n");
+	if (!exporter->streaming)
+		json_buf_append(&exporter->out, "\n]\n", 3);
+	
+	/* Close current file once its writes are done */
+	write_pending(exporter);
+	io_settle(exporter);
+	if (exporter->owns_fd) {
+		close(exporter->fd);
+		exporter->fd = -1;
 	}
 	
-	/* Close current file */
-	if (exporter->fp && exporter->owns_fp) {
-		fclose(exporter->fp);
-		exporter->fp = NULL;
-	}
+	/* Nothing may be renamed while it is being compressed */
+	file_compressor_wait(exporter->compressor);
 	
 	/* Delete oldest rotation if we've hit the limit */
 	if (exporter->policy.max_rotations > 0) {
@@ -140,26 +180,26 @@ static bool rotate_files(struct json_exporter *exporter)
 	if (old_name) {
 		rename(exporter->filename, old_name);
 		
-		if (exporter->policy.compress_rotated) {
-			compress_file(old_name);
-		}
+		if (exporter->compressor)
+			file_compressor_submit(exporter->compressor, old_name);
 		
 		free(old_name);
 	}
 	
 	/* Open new file */
-	exporter->fp = fopen(exporter->filename, "w");
-	if (!exporter->fp)
+	exporter->fd = open_output(exporter->filename);
+	if (exporter->fd < 0)
 		return false;
 	
-	exporter->owns_fp = true;
+	exporter->owns_fd = true;
 	exporter->first_event = true;
 	exporter->current_file_size = 0;
+	exporter->file_offset = 0;
 	exporter->rotations++;
 	
 	/* Start array if not streaming */
 	if (!exporter->streaming) {
-		fprintf(exporter->fp, "[\n");
+		json_buf_append(&exporter->out, "[\n", 2);
 		exporter->current_file_size += 2;
 	}
 	
@@ -181,23 +221,32 @@ struct json_exporter *json_exporter_create(const char *filename,
 	exporter->streaming = streaming;
 	exporter->first_event = true;
 	
+	if (!json_buf_init(&exporter->out, JSON_EXPORT_BATCH_BYTES + 4096)) {
+		free(exporter);
+		return NULL;
+	}
+	
 	if (filename) {
 		exporter->filename = strdup(filename);
 		if (!exporter->filename) {
+			json_buf_free(&exporter->out);
 			free(exporter);
 			return NULL;
 		}
 		
-		exporter->fp = fopen(filename, "w");
-		if (!exporter->fp) {
+		exporter->fd = open_output(filename);
+		if (exporter->fd < 0) {
 			free(exporter->filename);
+			json_buf_free(&exporter->out);
 			free(exporter);
 			return NULL;
 		}
-		exporter->owns_fp = true;
+		exporter->owns_fd = true;
 	} else {
-		exporter->fp = stdout;
-		exporter->owns_fp = false;
+		/* Anything stdio still holds goes out before our writes */
+		fflush(stdout);
+		exporter->fd = STDOUT_FILENO;
+		exporter->owns_fd = false;
 	}
 	
 	if (policy && filename) {
@@ -205,9 +254,25 @@ struct json_exporter *json_exporter_create(const char *filename,
 		exporter->has_policy = true;
 	}
 	
+	if (exporter->has_policy && policy->compress_rotated) {
+		struct file_compress_config compress_config = {
+			.level = policy->compress_level,
+			.threads = policy->compress_threads
+		};
+		
+		exporter->compressor = file_compressor_create(&compress_config);
+		if (!exporter->compressor) {
+			close(exporter->fd);
+			free(exporter->filename);
+			json_buf_free(&exporter->out);
+			free(exporter);
+			return NULL;
+		}
+	}
+	
 	/* Start array if not streaming */
 	if (!streaming) {
-		fprintf(exporter->fp, "[\n");
+		json_buf_append(&exporter->out, "[\n", 2);
 		exporter->current_file_size += 2;
 	}
 	
@@ -220,136 +285,198 @@ void json_exporter_destroy(struct json_exporter *exporter)
 		return;
 	
 	/* Close array if not streaming */
-	if (!exporter->streaming && exporter->fp) {
-		fprintf(exporter->fp, "\n]\n");
+	if (!exporter->streaming && exporter->fd >= 0)
+		json_buf_append(&exporter->out, "\n]\n", 3);
+	
+	if (exporter->fd >= 0) {
+		write_pending(exporter);
+		io_settle(exporter);
+		if (exporter->owns_fd)
+			close(exporter->fd);
 	}
 	
-	if (exporter->fp && exporter->owns_fp) {
-		fflush(exporter->fp);
-		fclose(exporter->fp);
-	}
+	/* Finishes the last rotated file */
+	file_compressor_destroy(exporter->compressor);
 	
+	json_buf_free(&exporter->out);
 	free(exporter->filename);
 	free(exporter);
 }
 
+/* ID of a correlation as a string, JSON numbers lose its low bits */
+static void append_correlation_id(struct json_buf *out,
+                                  const struct correlation_result *correlation)
+{
+	char id[24];
+	int len;
+	
+	len = snprintf(id, sizeof(id), "\"" CORRELATION_ID_FMT "\"", correlation->id);
+	json_buf_append(out, id, (size_t)len);
+}
+
 bool json_exporter_write_event(struct json_exporter *exporter,
                                struct json_event *event)
 {
-	size_t start_pos, end_pos;
+	struct json_buf *out;
+	size_t start_len;
 	
-	if (!exporter || !exporter->fp || !event)
+	if (!exporter || exporter->fd < 0 || !event)
 		return false;
 	
-	start_pos = ftell(exporter->fp);
+	out = &exporter->out;
+	start_len = out->len;
 	
-	/* Add comma separator if not first event and not streaming */
-	if (!exporter->streaming && !exporter->first_event) {
-		fprintf(exporter->fp, ",\n");
-	}
-	
-	/* Check if rotation is needed */
+	/* Check if rotation is needed, before the separator so the closed file stays valid */
 	if (exporter->has_policy && exporter->policy.max_file_size > 0 &&
 	    exporter->current_file_size > exporter->policy.max_file_size) {
 		if (!rotate_files(exporter))
 			return false;
-		start_pos = ftell(exporter->fp);
+		start_len = out->len;
 	}
 	
+	/* Add comma separator if not first event and not streaming */
+	if (!exporter->streaming && !exporter->first_event)
+		json_buf_append(out, ",\n", 2);
+	
 	/* Write event */
 	if (exporter->format == JSON_FORMAT_PRETTY) {
-		fprintf(exporter->fp, "  {\n");
-		fprintf(exporter->fp, "    \"timestamp\": \"%lu.%06lu\",\n",
-		        event->timestamp_sec, event->timestamp_usec);
-		fprintf(exporter->fp, "    \"sequence\": %lu,\n", event->sequence);
-		fprintf(exporter->fp, "    \"event_type\": ");
-		json_escape_string(exporter->fp, event->event_type);
-		fprintf(exporter->fp, ",\n");
-		fprintf(exporter->fp, "    \"message_type\": %u,\n", event->message_type);
-		fprintf(exporter->fp, "    \"message_type_str\": ");
-		json_escape_string(exporter->fp, event->message_type_str);
-		fprintf(exporter->fp, ",\n");
+		json_buf_append_str(out, "  {\n    \"timestamp\": \"");
+		json_buf_append_u64(out, event->timestamp_sec);
+		json_buf_append_char(out, '.');
+		json_buf_append_u64_padded(out, event->timestamp_usec, 6);
+		json_buf_append_str(out, "\",\n    \"sequence\": ");
+		json_buf_append_u64(out, event->sequence);
+		json_buf_append_str(out, ",\n    \"event_type\": ");
+		json_buf_append_string(out, event->event_type);
+		json_buf_append_str(out, ",\n    \"message_type\": ");
+		json_buf_append_u64(out, event->message_type);
+		json_buf_append_str(out, ",\n    \"message_type_str\": ");
+		json_buf_append_string(out, event->message_type_str);
+		json_buf_append_str(out, ",\n");
 		
 		if (event->interface) {
-			fprintf(exporter->fp, "    \"interface\": ");
-			json_escape_string(exporter->fp, event->interface);
-			fprintf(exporter->fp, ",\n");
+			json_buf_append_str(out, "    \"interface\": ");
+			json_buf_append_string(out, event->interface);
+			json_buf_append_str(out, ",\n");
 		}
 		
 		if (event->namespace) {
-			fprintf(exporter->fp, "    \"namespace\": ");
-			json_escape_string(exporter->fp, event->namespace);
-			fprintf(exporter->fp, ",\n");
+			json_buf_append_str(out, "    \"namespace\": ");
+			json_buf_append_string(out, event->namespace);
+			json_buf_append_str(out, ",\n");
 		}
 		
-		if (event->correlation_id) {
-			fprintf(exporter->fp, "    \"correlation_id\": ");
-			json_escape_string(exporter->fp, event->correlation_id);
-			fprintf(exporter->fp, ",\n");
+		if (event->correlation) {
+			json_buf_append_str(out, "    \"correlation_id\": ");
+			append_correlation_id(out, event->correlation);
+			json_buf_append_str(out, ",\n    \"correlation_rule\": ");
+			json_buf_append_string(out, event->correlation->rule_name);
+			json_buf_append_str(out, ",\n");
 		}
 		
-		if (event->details) {
-			fprintf(exporter->fp, "    \"details\": %s\n", event->details);
-		} else {
-			fprintf(exporter->fp, "    \"details\": null\n");
+		if (event->sample_weight > 1) {
+			json_buf_append_str(out, "    \"sample_weight\": ");
+			json_buf_append_u64(out, event->sample_weight);
+			json_buf_append_str(out, ",\n");
 		}
 		
-		fprintf(exporter->fp, "  }");
+		json_buf_append_str(out, "    \"details\": ");
+		json_buf_append_str(out, event->details ? event->details : "null");
+		json_buf_append_str(out, "\n  }");
 	} else {
 		/* Compact format */
-		fprintf(exporter->fp, "{\"timestamp\":\"%lu.%06lu\",\"sequence\":%lu,\"event_type\":",
-		        event->timestamp_sec, event->timestamp_usec, event->sequence);
-		json_escape_string(exporter->fp, event->event_type);
-		fprintf(exporter->fp, ",\"message_type\":%u,\"message_type_str\":",
-		        event->message_type);
-		json_escape_string(exporter->fp, event->message_type_str);
+		json_buf_append_str(out, "{\"timestamp\":\"");
+		json_buf_append_u64(out, event->timestamp_sec);
+		json_buf_append_char(out, '.');
+		json_buf_append_u64_padded(out, event->timestamp_usec, 6);
+		json_buf_append_str(out, "\",\"sequence\":");
+		json_buf_append_u64(out, event->sequence);
+		json_buf_append_str(out, ",\"event_type\":");
+		json_buf_append_string(out, event->event_type);
+		json_buf_append_str(out, ",\"message_type\":");
+		json_buf_append_u64(out, event->message_type);
+		json_buf_append_str(out, ",\"message_type_str\":");
+		json_buf_append_string(out, event->message_type_str);
 		
 		if (event->interface) {
-			fprintf(exporter->fp, ",\"interface\":");
-			json_escape_string(exporter->fp, event->interface);
+			json_buf_append_str(out, ",\"interface\":");
+			json_buf_append_string(out, event->interface);
 		}
 		
 		if (event->namespace) {
-			fprintf(exporter->fp, ",\"namespace\":");
-			json_escape_string(exporter->fp, event->namespace);
+			json_buf_append_str(out, ",\"namespace\":");
+			json_buf_append_string(out, event->namespace);
 		}
 		
-		if (event->correlation_id) {
-			fprintf(exporter->fp, ",\"correlation_id\":");
-			json_escape_string(exporter->fp, event->correlation_id);
+		if (event->correlation) {
+			json_buf_append_str(out, ",\"correlation_id\":");
+			append_correlation_id(out, event->correlation);
+			json_buf_append_str(out, ",\"correlation_rule\":");
+			json_buf_append_string(out, event->correlation->rule_name);
 		}
 		
-		fprintf(exporter->fp, ",\"details\":");
-		if (event->details) {
-			fprintf(exporter->fp, "%s", event->details);
-		} else {
-			fprintf(exporter->fp, "null");
+		if (event->sample_weight > 1) {
+			json_buf_append_str(out, ",\"sample_weight\":");
+			json_buf_append_u64(out, event->sample_weight);
 		}
 		
-		fprintf(exporter->fp, "}");
+		json_buf_append_str(out, ",\"details\":");
+		json_buf_append_str(out, event->details ? event->details : "null");
+		json_buf_append_char(out, '}');
 	}
 	
 	/* Add newline in streaming mode */
-	if (exporter->streaming) {
-		fprintf(exporter->fp, "\n");
-	}
+	if (exporter->streaming)
+		json_buf_append_char(out, '\n');
 	
-	end_pos = ftell(exporter->fp);
+	if (out->failed) {
+		json_buf_reset(out);
+		return false;
+	}
 	
 	exporter->first_event = false;
 	exporter->events_written++;
-	exporter->bytes_written += (end_pos - start_pos);
-	exporter->current_file_size += (end_pos - start_pos);
+	exporter->bytes_written += out->len - start_len;
+	exporter->current_file_size += out->len - start_len;
+	
+	/* Events are written out in batches */
+	if (out->len >= JSON_EXPORT_BATCH_BYTES)
+		return write_pending(exporter);
 	
 	return true;
 }
 
 bool json_exporter_flush(struct json_exporter *exporter)
 {
-	if (!exporter || !exporter->fp)
+	bool result;
+	
+	if (!exporter || exporter->fd < 0)
 		return false;
 	
-	return fflush(exporter->fp) == 0;
+	result = write_pending(exporter);
+	return io_settle(exporter) && result;
+}
+
+bool json_exporter_set_io_service(struct json_exporter *exporter, struct io_service *io)
+{
+	off_t pos;
+	
+	if (!exporter || exporter->fd < 0)
+		return false;
+	
+	/* Switch over at a known file offset */
+	if (!json_exporter_flush(exporter))
+		return false;
+	
+	if (io && exporter->owns_fd) {
+		pos = lseek(exporter->fd, 0, SEEK_CUR);
+		if (pos < 0)
+			return false;
+		exporter->file_offset = (uint64_t)pos;
+	}
+	
+	exporter->io = io;
+	return true;
 }
 
 bool json_exporter_get_stats(struct json_exporter *exporter,
@@ -1,6 +1,14 @@
-/* log_rotation.c - Log file rotation and compression */
+/* log_rotation.c - Log file rotation and compression
+ *
+ * A rotation only renames the current file aside and moves the next
+ * file, opened ahead by the rotation thread, to the base name. Closing
+ * the old file, renaming the chain, pruning and compression happen on
+ * the rotation thread, in the order of the rotations.
+ */
 
 #include "log_rotation.h"
+#include "file_compress.h"
+#include "thread_affinity.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -8,11 +16,22 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <pthread.h>
+
+/* Rotated file waiting for the rotation thread */
+struct rotation_job {
+	struct rotation_job *next;
+	FILE *fp;                       /* Closed by the rotation thread */
+	char *path;                     /* Name it was renamed aside to */
+	uint64_t queued_ns;
+};
 
 struct log_rotator {
 	char *base_filename;
+	char *next_filename;
 	FILE *fp;
 	struct log_rotation_policy policy;
+	struct file_compressor *compressor;  /* Set when rotated files are compressed */
 	
 	/* State tracking */
 	uint64_t bytes_written;
@@ -20,18 +39,21 @@ struct log_rotator {
 	uint32_t rotations;
 	time_t last_rotation_time;
 	time_t next_rotation_time;
-};
-
-static bool compress_file(const char *filename)
-{
-	char cmd[1024];
-	int ret;
-	
-	snprintf(cmd, sizeof(cmd), "gzip -f '%s' 2>/dev/null", filename);
-	ret = system(cmd);
 	
-	return ret == 0;
-}
+	/* Rotation thread, the lock covers the fields below */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t idle;
+	bool running;
+	bool want_next;                 /* next_fp was taken */
+	FILE *next_fp;                  /* Open at next_filename */
+	struct rotation_job *jobs;
+	struct rotation_job *jobs_tail;
+	uint32_t pending;
+	uint64_t swap_ns_max;
+	uint64_t rotation_us_max;
+};
 
 static char *generate_rotated_filename(const char *base, uint32_t rotation)
 {
@@ -112,17 +134,34 @@ static time_t calculate_next_rotation_time(struct log_rotation_policy *policy,
 	return next_time;
 }
 
-static bool rotate_files(struct log_rotator *rotator)
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static FILE *open_log(struct log_rotator *rotator, const char *path, const char *mode)
+{
+	FILE *fp = fopen(path, mode);
+	
+	/* Set buffering mode */
+	if (fp && rotator->policy.sync_writes) {
+		setvbuf(fp, NULL, _IONBF, 0);
+	}
+	
+	return fp;
+}
+
+/* Shift the rotated files up by one and make the retired file .0 */
+static void rename_chain(struct log_rotator *rotator, const char *retired)
 {
 	char *old_name, *new_name;
 	uint32_t i;
 	
-	/* Close current file */
-	if (rotator->fp) {
-		fflush(rotator->fp);
-		fclose(rotator->fp);
-		rotator->fp = NULL;
-	}
+	/* Nothing may be renamed while it is being compressed */
+	file_compressor_wait(rotator->compressor);
 	
 	/* Delete oldest rotation if we've hit the limit */
 	if (rotator->policy.max_rotations > 0) {
@@ -166,29 +205,132 @@ static bool rotate_files(struct log_rotator *rotator)
 		free(new_name);
 	}
 	
-	/* Rename current file to .0 */
+	/* Rename retired file to .0 */
 	old_name = generate_rotated_filename(rotator->base_filename, 0);
 	if (old_name) {
-		rename(rotator->base_filename, old_name);
+		rename(retired, old_name);
 		
 		/* Compress if requested */
-		if (rotator->policy.compress_rotated) {
-			compress_file(old_name);
-		}
+		if (rotator->compressor)
+			file_compressor_submit(rotator->compressor, old_name);
 		
 		free(old_name);
 	}
+}
+
+/* Background thread, retires rotated files and keeps the next one open */
+static void *rotation_thread(void *arg)
+{
+	struct log_rotator *rotator = arg;
+	struct rotation_job *job;
+	uint64_t latency_us;
+	FILE *fp;
 	
-	/* Open new file */
-	rotator->fp = fopen(rotator->base_filename, "a");
-	if (!rotator->fp)
+	pthread_mutex_lock(&rotator->lock);
+	
+	for (;;) {
+		while (!rotator->jobs && !rotator->want_next && rotator->running)
+			pthread_cond_wait(&rotator->work, &rotator->lock);
+		
+		if (rotator->jobs) {
+			job = rotator->jobs;
+			rotator->jobs = job->next;
+			if (!rotator->jobs)
+				rotator->jobs_tail = NULL;
+			pthread_mutex_unlock(&rotator->lock);
+			
+			fclose(job->fp);
+			rename_chain(rotator, job->path);
+			latency_us = (now_ns() - job->queued_ns) / 1000;
+			free(job->path);
+			free(job);
+			
+			pthread_mutex_lock(&rotator->lock);
+			rotator->pending--;
+			if (latency_us > rotator->rotation_us_max)
+				rotator->rotation_us_max = latency_us;
+			pthread_cond_broadcast(&rotator->idle);
+			continue;
+		}
+		
+		if (!rotator->running)
+			break;
+		
+		/* Truncated, it may be left over from a crash. On error writers
+		 * open the new file themselves at the next rotation. */
+		rotator->want_next = false;
+		pthread_mutex_unlock(&rotator->lock);
+		fp = open_log(rotator, rotator->next_filename, "w");
+		pthread_mutex_lock(&rotator->lock);
+		rotator->next_fp = fp;
+	}
+	
+	pthread_mutex_unlock(&rotator->lock);
+	return NULL;
+}
+
+/*
+ * Switch writes to a new file. The current file is renamed aside and
+ * the pre-opened next file takes the base name, the rest of the rotation
+ * is queued for the rotation thread.
+ */
+static bool rotate_files(struct log_rotator *rotator)
+{
+	struct rotation_job *job;
+	uint64_t start = now_ns(), swap_ns;
+	size_t len = strlen(rotator->base_filename) + 32;
+	FILE *fp;
+	
+	job = calloc(1, sizeof(*job));
+	if (!job)
 		return false;
 	
-	/* Set buffering mode */
-	if (rotator->policy.sync_writes) {
-		setvbuf(rotator->fp, NULL, _IONBF, 0);
+	job->path = malloc(len);
+	if (!job->path) {
+		free(job);
+		return false;
+	}
+	snprintf(job->path, len, "%s.rotating.%u", rotator->base_filename, rotator->rotations);
+	
+	if (rename(rotator->base_filename, job->path) != 0)
+		goto err_free;
+	
+	pthread_mutex_lock(&rotator->lock);
+	fp = rotator->next_fp;
+	rotator->next_fp = NULL;
+	if (fp && rename(rotator->next_filename, rotator->base_filename) != 0) {
+		fclose(fp);
+		fp = NULL;
+	}
+	pthread_mutex_unlock(&rotator->lock);
+	
+	/* The rotation thread did not get to the next file yet */
+	if (!fp)
+		fp = open_log(rotator, rotator->base_filename, "a");
+	if (!fp) {
+		rename(job->path, rotator->base_filename);
+		goto err_free;
 	}
 	
+	job->fp = rotator->fp;
+	job->queued_ns = now_ns();
+	rotator->fp = fp;
+	
+	swap_ns = job->queued_ns - start;
+	
+	pthread_mutex_lock(&rotator->lock);
+	if (rotator->jobs_tail)
+		rotator->jobs_tail->next = job;
+	else
+		rotator->jobs = job;
+	rotator->jobs_tail = job;
+	rotator->pending++;
+	rotator->want_next = true;
+	if (swap_ns > rotator->swap_ns_max)
+		rotator->swap_ns_max = swap_ns;
+	pthread_cond_signal(&rotator->work);
+	pthread_mutex_unlock(&rotator->lock);
+	
 	rotator->current_file_size = 0;
 	rotator->rotations++;
 	rotator->last_rotation_time = time(NULL);
@@ -196,6 +338,11 @@ static bool rotate_files(struct log_rotator *rotator)
 	                                                           rotator->last_rotation_time);
 	
 	return true;
+	
+err_free:
+	free(job->path);
+	free(job);
+	return false;
 }
 
 struct log_rotator *log_rotator_create(const char *base_filename,
@@ -203,6 +350,7 @@ struct log_rotator *log_rotator_create(const char *base_filename,
 {
 	struct log_rotator *rotator;
 	struct stat st;
+	size_t len;
 	
 	if (!base_filename || !policy)
 		return NULL;
@@ -211,26 +359,21 @@ struct log_rotator *log_rotator_create(const char *base_filename,
 	if (!rotator)
 		return NULL;
 	
+	rotator->policy = *policy;
 	rotator->base_filename = strdup(base_filename);
-	if (!rotator->base_filename) {
-		free(rotator);
-		return NULL;
-	}
+	if (!rotator->base_filename)
+		goto err_free;
 	
-	rotator->policy = *policy;
+	len = strlen(base_filename) + 8;
+	rotator->next_filename = malloc(len);
+	if (!rotator->next_filename)
+		goto err_names;
+	snprintf(rotator->next_filename, len, "%s.next", base_filename);
 	
 	/* Open log file */
-	rotator->fp = fopen(base_filename, "a");
-	if (!rotator->fp) {
-		free(rotator->base_filename);
-		free(rotator);
-		return NULL;
-	}
-	
-	/* Set buffering mode */
-	if (policy->sync_writes) {
-		setvbuf(rotator->fp, NULL, _IONBF, 0);
-	}
+	rotator->fp = open_log(rotator, base_filename, "a");
+	if (!rotator->fp)
+		goto err_names;
 	
 	/* Get current file size */
 	if (stat(base_filename, &st) == 0) {
@@ -241,7 +384,48 @@ struct log_rotator *log_rotator_create(const char *base_filename,
 	rotator->next_rotation_time = calculate_next_rotation_time(policy,
 	                                                           rotator->last_rotation_time);
 	
+	if (policy->compress_rotated) {
+		struct file_compress_config compress_config = {
+			.level = policy->compress_level,
+			.threads = policy->compress_threads
+		};
+		
+		rotator->compressor = file_compressor_create(&compress_config);
+		if (!rotator->compressor)
+			goto err_close;
+	}
+	
+	if (pthread_mutex_init(&rotator->lock, NULL) != 0)
+		goto err_compressor;
+	if (pthread_cond_init(&rotator->work, NULL) != 0)
+		goto err_lock;
+	if (pthread_cond_init(&rotator->idle, NULL) != 0)
+		goto err_work;
+	
+	rotator->running = true;
+	rotator->want_next = true;
+	if (pthread_create(&rotator->thread, NULL, rotation_thread, rotator) != 0)
+		goto err_idle;
+	thread_affinity_apply(rotator->thread, NULL, -1, "log-rotate");
+	
 	return rotator;
+	
+err_idle:
+	pthread_cond_destroy(&rotator->idle);
+err_work:
+	pthread_cond_destroy(&rotator->work);
+err_lock:
+	pthread_mutex_destroy(&rotator->lock);
+err_compressor:
+	file_compressor_destroy(rotator->compressor);
+err_close:
+	fclose(rotator->fp);
+err_names:
+	free(rotator->next_filename);
+	free(rotator->base_filename);
+err_free:
+	free(rotator);
+	return NULL;
 }
 
 void log_rotator_destroy(struct log_rotator *rotator)
@@ -249,11 +433,30 @@ void log_rotator_destroy(struct log_rotator *rotator)
 	if (!rotator)
 		return;
 	
+	/* The thread retires the queued files before it exits */
+	pthread_mutex_lock(&rotator->lock);
+	rotator->running = false;
+	pthread_cond_signal(&rotator->work);
+	pthread_mutex_unlock(&rotator->lock);
+	pthread_join(rotator->thread, NULL);
+	
+	if (rotator->next_fp) {
+		fclose(rotator->next_fp);
+		unlink(rotator->next_filename);
+	}
+	
 	if (rotator->fp) {
 		fflush(rotator->fp);
 		fclose(rotator->fp);
 	}
 	
+	/* Finishes the last rotated file */
+	file_compressor_destroy(rotator->compressor);
+	
+	pthread_cond_destroy(&rotator->idle);
+	pthread_cond_destroy(&rotator->work);
+	pthread_mutex_destroy(&rotator->lock);
+	free(rotator->next_filename);
 	free(rotator->base_filename);
 	free(rotator);
 }
@@ -270,9 +473,6 @@ ssize_t log_rotator_write(struct log_rotator *rotator,
 	/* Check if rotation is needed */
 	log_rotator_check_rotation(rotator);
 	
-	if (!rotator->fp)
-		return -1;
-	
 	written = fwrite(data, 1, len, rotator->fp);
 	if (written > 0) {
 		rotator->bytes_written += written;
@@ -298,9 +498,6 @@ ssize_t log_rotator_printf(struct log_rotator *rotator,
 	/* Check if rotation is needed */
 	log_rotator_check_rotation(rotator);
 	
-	if (!rotator->fp)
-		return -1;
-	
 	va_start(args, format);
 	written = vfprintf(rotator->fp, format, args);
 	va_end(args);
@@ -368,11 +565,23 @@ bool log_rotator_force_rotation(struct log_rotator *rotator)
 	return rotate_files(rotator);
 }
 
+void log_rotator_wait(struct log_rotator *rotator)
+{
+	if (!rotator)
+		return;
+	
+	pthread_mutex_lock(&rotator->lock);
+	while (rotator->pending > 0)
+		pthread_cond_wait(&rotator->idle, &rotator->lock);
+	pthread_mutex_unlock(&rotator->lock);
+}
+
 bool log_rotator_get_stats(struct log_rotator *rotator,
                            uint64_t *bytes_written,
                            uint64_t *current_file_size,
                            uint32_t *rotations,
-                           time_t *last_rotation_time)
+                           time_t *last_rotation_time,
+                           struct log_rotation_latency *latency)
 {
 	if (!rotator)
 		return false;
@@ -386,5 +595,13 @@ bool log_rotator_get_stats(struct log_rotator *rotator,
 	if (last_rotation_time)
 		*last_rotation_time = rotator->last_rotation_time;
 	
+	if (latency) {
+		pthread_mutex_lock(&rotator->lock);
+		latency->swap_ns_max = rotator->swap_ns_max;
+		latency->rotation_us_max = rotator->rotation_us_max;
+		latency->pending = rotator->pending;
+		pthread_mutex_unlock(&rotator->lock);
+	}
+	
 	return true;
 }
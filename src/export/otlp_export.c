@@ -0,0 +1,1041 @@
+/* otlp_export.c - OpenTelemetry (OTLP/HTTP) log and metric exporter
+ *
+ * Log records are encoded as they come into the batch being filled, so
+ * sealing a batch only wraps it in the resource and scope messages.
+ * Batches are sealed at the adaptive batcher's size and linger time,
+ * which follow the delivery latency of the requests they become. A
+ * sealed batch, or a metrics collection, becomes a request: its body
+ * gzipped once and kept until the collector takes it, gives it up for
+ * good or it has been retried for too long. Requests go out in order,
+ * one at a time, over a kept-alive curl handle.
+ *
+ * The protobuf messages of opentelemetry-proto are written by hand like
+ * the Prometheus exporter does, the few nested lengths that are not
+ * known up front computed rather than encoded twice.
+ *
+ * All calls but otlp_exporter_get_stats() come from one thread, which
+ * does the sending; the lock only guards the statistics.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "otlp_export.h"
+#include "prometheus_exporter.h"
+#include "event_processor.h"
+#include "json_buf.h"
+#include "adaptive_batch.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <curl/curl.h>
+#include <zlib.h>
+
+#define PB_VARINT 0
+#define PB_FIXED64 1
+#define PB_BYTES 2
+
+/* opentelemetry-proto enum values */
+#define SEVERITY_INFO 9
+#define TEMPORALITY_CUMULATIVE 2
+
+#define SCOPE_NAME "nlmon"
+
+/* What a request carries */
+enum otlp_signal {
+	OTLP_LOGS,
+	OTLP_METRICS,
+};
+
+/* A request body, waiting to be sent */
+struct otlp_request {
+	struct otlp_request *next;
+	enum otlp_signal signal;
+	uint32_t count;                 /* Log records or data points */
+	uint64_t opened_ns;             /* First record of a logs batch */
+	uint64_t first_ns;              /* First attempt */
+	uint64_t next_ns;               /* Next attempt not before */
+	unsigned int attempts;
+	size_t len;
+	unsigned char body[];
+};
+
+/* Outcome of a request */
+enum send_result {
+	SEND_OK,
+	SEND_RETRY,
+	SEND_FAIL,
+};
+
+struct otlp_exporter {
+	struct otlp_config config;
+	char *urls[2];                  /* By enum otlp_signal */
+	CURL *curl;
+	struct curl_slist *headers;
+	unsigned int seed;
+	
+	/* Encoded Resource and InstrumentationScope fields */
+	struct json_buf resource;
+	struct json_buf scope;
+	
+	/* Batch being filled, LogRecord fields of a ScopeLogs */
+	struct json_buf records;
+	uint32_t record_count;
+	uint64_t first_ns;
+	struct adaptive_batch *batcher; /* Records and linger of a batch */
+	
+	/* Metrics collection, Metric fields of a ScopeMetrics */
+	struct json_buf metrics;
+	uint32_t point_count;
+	uint64_t start_unix_ns;
+	uint64_t collect_unix_ns;
+	uint64_t next_metrics_ns;
+	
+	/* Scratch for nested messages and the request being built */
+	struct json_buf scratch[3];
+	struct json_buf body;
+	unsigned char *zbuf;
+	size_t zbuf_size;
+	
+	/* Requests in order, the head is sent next */
+	struct otlp_request *head;
+	struct otlp_request *tail;
+	
+	/* Statistics and pending counts, guarded by lock */
+	pthread_mutex_t lock;
+	struct otlp_stats stats;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t unix_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Protobuf encoding */
+
+static size_t varint_size(uint64_t value)
+{
+	size_t len = 1;
+	
+	while (value >= 0x80) {
+		value >>= 7;
+		len++;
+	}
+	return len;
+}
+
+/* Bytes of a length delimited field below 16 */
+static size_t bytes_size(size_t len)
+{
+	return 1 + varint_size(len) + len;
+}
+
+static void pb_varint(struct json_buf *buf, uint64_t value)
+{
+	char bytes[10];
+	size_t len = 0;
+	
+	while (value >= 0x80) {
+		bytes[len++] = (char)(value | 0x80);
+		value >>= 7;
+	}
+	bytes[len++] = (char)value;
+	
+	json_buf_append(buf, bytes, len);
+}
+
+static inline void pb_key(struct json_buf *buf, unsigned int field, unsigned int wire)
+{
+	pb_varint(buf, (uint64_t)field << 3 | wire);
+}
+
+static void pb_uint(struct json_buf *buf, unsigned int field, uint64_t value)
+{
+	pb_key(buf, field, PB_VARINT);
+	pb_varint(buf, value);
+}
+
+static void put_fixed64(struct json_buf *buf, uint64_t value)
+{
+	char bytes[8];
+	
+	for (int i = 0; i < 8; i++)
+		bytes[i] = (char)(value >> (8 * i));
+	json_buf_append(buf, bytes, sizeof(bytes));
+}
+
+static void pb_fixed64(struct json_buf *buf, unsigned int field, uint64_t value)
+{
+	pb_key(buf, field, PB_FIXED64);
+	put_fixed64(buf, value);
+}
+
+static uint64_t double_bits(double value)
+{
+	uint64_t bits;
+	
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static void pb_double(struct json_buf *buf, unsigned int field, double value)
+{
+	pb_fixed64(buf, field, double_bits(value));
+}
+
+static void pb_bytes(struct json_buf *buf, unsigned int field, const char *data, size_t len)
+{
+	pb_key(buf, field, PB_BYTES);
+	pb_varint(buf, len);
+	json_buf_append(buf, data, len);
+}
+
+static void pb_string(struct json_buf *buf, unsigned int field, const char *str)
+{
+	pb_bytes(buf, field, str, strlen(str));
+}
+
+/* Append sub as an embedded message and empty it for the next one */
+static void pb_message(struct json_buf *buf, unsigned int field, struct json_buf *sub)
+{
+	pb_bytes(buf, field, sub->data, sub->len);
+	buf->failed |= sub->failed;
+	json_buf_reset(sub);
+}
+
+/* KeyValue with a string AnyValue */
+static void pb_attr_string(struct json_buf *buf, unsigned int field, const char *key,
+                           const char *value, size_t len)
+{
+	size_t klen = strlen(key);
+	size_t any = bytes_size(len);
+	
+	pb_key(buf, field, PB_BYTES);
+	pb_varint(buf, bytes_size(klen) + bytes_size(any));
+	pb_bytes(buf, 1, key, klen);
+	pb_key(buf, 2, PB_BYTES);
+	pb_varint(buf, any);
+	pb_bytes(buf, 1, value, len);
+}
+
+/* KeyValue with an int AnyValue */
+static void pb_attr_int(struct json_buf *buf, unsigned int field, const char *key,
+                        int64_t value)
+{
+	size_t klen = strlen(key);
+	size_t any = 1 + varint_size((uint64_t)value);
+	
+	pb_key(buf, field, PB_BYTES);
+	pb_varint(buf, bytes_size(klen) + bytes_size(any));
+	pb_bytes(buf, 1, key, klen);
+	pb_key(buf, 2, PB_BYTES);
+	pb_varint(buf, any);
+	pb_uint(buf, 3, (uint64_t)value);
+}
+
+/* KeyValue attributes for each name="value" of a Prometheus label string */
+static void pb_label_attrs(struct json_buf *buf, unsigned int field, const char *labels)
+{
+	char name[128], value[256];
+	
+	while (labels && *labels) {
+		const char *eq = strchr(labels, '=');
+		size_t nlen, len = 0;
+	
+		if (!eq || eq[1] != '"')
+			return;
+	
+		nlen = (size_t)(eq - labels);
+		if (nlen >= sizeof(name))
+			return;
+		memcpy(name, labels, nlen);
+		name[nlen] = '\0';
+	
+		labels = eq + 2;
+		while (*labels && *labels != '"' && len < sizeof(value)) {
+			char c = *labels++;
+	
+			if (c == '\\' && *labels) {
+				c = *labels++;
+				if (c == 'n')
+					c = '\n';
+			}
+			value[len++] = c;
+		}
+		pb_attr_string(buf, field, name, value, len);
+	
+		if (*labels == '"')
+			labels++;
+		while (*labels == ',' || *labels == ' ')
+			labels++;
+	}
+}
+
+/* Requests */
+
+static bool compress_body(struct otlp_exporter *exporter, const struct json_buf *body,
+                          const unsigned char **out, size_t *out_len)
+{
+	z_stream zs;
+	uLong bound;
+	int ret;
+	
+	if (exporter->config.level < 0) {
+		*out = (const unsigned char *)body->data;
+		*out_len = body->len;
+		return true;
+	}
+	
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, exporter->config.level, Z_DEFLATED, 15 + 16, 8,
+	                 Z_DEFAULT_STRATEGY) != Z_OK)
+		return false;
+	
+	bound = deflateBound(&zs, body->len);
+	if (bound > exporter->zbuf_size) {
+		unsigned char *zbuf = realloc(exporter->zbuf, bound);
+	
+		if (!zbuf) {
+			deflateEnd(&zs);
+			return false;
+		}
+		exporter->zbuf = zbuf;
+		exporter->zbuf_size = bound;
+	}
+	
+	zs.next_in = (Bytef *)body->data;
+	zs.avail_in = (uInt)body->len;
+	zs.next_out = exporter->zbuf;
+	zs.avail_out = (uInt)bound;
+	ret = deflate(&zs, Z_FINISH);
+	*out = exporter->zbuf;
+	*out_len = zs.total_out;
+	deflateEnd(&zs);
+	
+	return ret == Z_STREAM_END;
+}
+
+/* Drop the head request, counting what it carried as lost */
+static void request_drop(struct otlp_exporter *exporter, bool failed)
+{
+	struct otlp_request *req = exporter->head;
+	
+	exporter->head = req->next;
+	if (!exporter->head)
+		exporter->tail = NULL;
+	
+	pthread_mutex_lock(&exporter->lock);
+	if (failed)
+		exporter->stats.failed++;
+	if (req->signal == OTLP_LOGS)
+		exporter->stats.dropped += req->count;
+	exporter->stats.pending--;
+	exporter->stats.pending_bytes -= req->len;
+	pthread_mutex_unlock(&exporter->lock);
+	
+	free(req);
+}
+
+/* Queue the request in exporter->body, oldest ones making room */
+static bool request_push(struct otlp_exporter *exporter, enum otlp_signal signal,
+                         uint32_t count)
+{
+	const unsigned char *data;
+	struct otlp_request *req;
+	size_t len;
+	
+	if (exporter->body.failed || !compress_body(exporter, &exporter->body, &data, &len))
+		goto fail;
+	
+	while (exporter->head && exporter->stats.pending_bytes + len > exporter->config.memory_limit)
+		request_drop(exporter, false);
+	
+	req = malloc(sizeof(*req) + len);
+	if (!req)
+		goto fail;
+	memset(req, 0, sizeof(*req));
+	req->signal = signal;
+	req->count = count;
+	req->len = len;
+	memcpy(req->body, data, len);
+	
+	if (exporter->tail)
+		exporter->tail->next = req;
+	else
+		exporter->head = req;
+	exporter->tail = req;
+	
+	pthread_mutex_lock(&exporter->lock);
+	exporter->stats.pending++;
+	exporter->stats.pending_bytes += len;
+	pthread_mutex_unlock(&exporter->lock);
+	
+	json_buf_reset(&exporter->body);
+	return true;
+
+fail:
+	pthread_mutex_lock(&exporter->lock);
+	exporter->stats.failed++;
+	if (signal == OTLP_LOGS)
+		exporter->stats.dropped += count;
+	pthread_mutex_unlock(&exporter->lock);
+	json_buf_reset(&exporter->body);
+	return false;
+}
+
+static size_t response_discard(char *data, size_t size, size_t nmemb, void *ctx)
+{
+	(void)data;
+	(void)ctx;
+	return size * nmemb;
+}
+
+static enum send_result request_send(struct otlp_exporter *exporter,
+                                     const struct otlp_request *req, uint64_t *retry_after_ms)
+{
+	long code = 0;
+	CURLcode res;
+	
+	curl_easy_setopt(exporter->curl, CURLOPT_URL, exporter->urls[req->signal]);
+	curl_easy_setopt(exporter->curl, CURLOPT_POSTFIELDSIZE, (long)req->len);
+	curl_easy_setopt(exporter->curl, CURLOPT_POSTFIELDS, (const char *)req->body);
+	
+	res = curl_easy_perform(exporter->curl);
+	
+	pthread_mutex_lock(&exporter->lock);
+	exporter->stats.bytes_sent += req->len;
+	pthread_mutex_unlock(&exporter->lock);
+	
+	if (res != CURLE_OK)
+		return SEND_RETRY;
+	
+	curl_easy_getinfo(exporter->curl, CURLINFO_RESPONSE_CODE, &code);
+	if (code >= 200 && code < 300)
+		return SEND_OK;
+	if (code != 429 && code != 502 && code != 503 && code != 504)
+		return SEND_FAIL;
+
+#if LIBCURL_VERSION_NUM >= 0x074200
+	{
+		curl_off_t retry_after = 0;
+	
+		if (curl_easy_getinfo(exporter->curl, CURLINFO_RETRY_AFTER, &retry_after) == CURLE_OK &&
+		    retry_after > 0)
+			*retry_after_ms = (uint64_t)retry_after * 1000;
+	}
+#endif
+	return SEND_RETRY;
+}
+
+/* Exponential backoff with jitter, at least what the collector asked for */
+static uint64_t backoff_ms(struct otlp_exporter *exporter, unsigned int attempts,
+                           uint64_t retry_after_ms)
+{
+	uint64_t delay = exporter->config.retry_initial_ms;
+	
+	for (unsigned int i = 1; i < attempts && delay < exporter->config.retry_max_ms; i++)
+		delay *= 2;
+	if (delay > exporter->config.retry_max_ms)
+		delay = exporter->config.retry_max_ms;
+	delay = delay / 2 + (uint64_t)rand_r(&exporter->seed) % (delay / 2 + 1);
+	
+	return retry_after_ms > delay ? retry_after_ms : delay;
+}
+
+/*
+ * Send requests in order until one has to wait. Each waiting request is
+ * tried once regardless of its backoff if @force.
+ *
+ * Returns: true if no request is left
+ */
+static bool pump(struct otlp_exporter *exporter, bool force)
+{
+	uint64_t now = now_ns();
+	
+	while (exporter->head) {
+		struct otlp_request *req = exporter->head;
+		uint64_t retry_after_ms = 0;
+	
+		if (!force && req->next_ns > now)
+			return false;
+	
+		if (req->attempts++ == 0) {
+			req->first_ns = now;
+		} else {
+			pthread_mutex_lock(&exporter->lock);
+			exporter->stats.retries++;
+			pthread_mutex_unlock(&exporter->lock);
+		}
+	
+		switch (request_send(exporter, req, &retry_after_ms)) {
+		case SEND_OK:
+			if (req->signal == OTLP_LOGS) {
+				uint64_t done = now_ns();
+				
+				adaptive_batch_record(exporter->batcher, req->count, req->first_ns - req->opened_ns,
+				                      done - req->first_ns, done);
+			}
+			exporter->head = req->next;
+			if (!exporter->head)
+				exporter->tail = NULL;
+			pthread_mutex_lock(&exporter->lock);
+			exporter->stats.requests++;
+			if (req->signal == OTLP_METRICS)
+				exporter->stats.metric_points += req->count;
+			exporter->stats.pending--;
+			exporter->stats.pending_bytes -= req->len;
+			pthread_mutex_unlock(&exporter->lock);
+			free(req);
+			break;
+	
+		case SEND_FAIL:
+			request_drop(exporter, true);
+			break;
+	
+		case SEND_RETRY:
+			now = now_ns();
+			if (now - req->first_ns >= exporter->config.retry_elapsed_ms * 1000000ULL) {
+				request_drop(exporter, true);
+				break;
+			}
+			req->next_ns = now + backoff_ms(exporter, req->attempts, retry_after_ms) * 1000000ULL;
+			return false;
+		}
+		now = now_ns();
+	}
+	
+	return true;
+}
+
+/* Logs */
+
+static void encode_record(struct otlp_exporter *exporter, const struct nlmon_event *event)
+{
+	struct json_buf *rec = &exporter->scratch[0];
+	char body[192];
+	int len;
+	
+	pb_fixed64(rec, 1, event->timestamp);
+	pb_uint(rec, 2, SEVERITY_INFO);
+	pb_string(rec, 3, "INFO");
+	
+	len = snprintf(body, sizeof(body), "type=%u msg_type=%u interface=%.16s seq=%" PRIu64,
+	               event->event_type, event->message_type,
+	               event->interface[0] ? event->interface : "-", event->sequence);
+	if (len < 0)
+		len = 0;
+	if ((size_t)len >= sizeof(body))
+		len = sizeof(body) - 1;
+	pb_key(rec, 5, PB_BYTES);
+	pb_varint(rec, bytes_size((size_t)len));
+	pb_bytes(rec, 1, body, (size_t)len);
+	
+	pb_attr_int(rec, 6, "nlmon.event_type", event->event_type);
+	pb_attr_int(rec, 6, "nlmon.message_type", event->message_type);
+	pb_attr_int(rec, 6, "nlmon.sequence", (int64_t)event->sequence);
+	if (event->interface[0])
+		pb_attr_string(rec, 6, "network.interface.name", event->interface,
+		               strnlen(event->interface, sizeof(event->interface)));
+	pb_attr_int(rec, 6, "netlink.protocol", event->netlink.protocol);
+	pb_attr_int(rec, 6, "netlink.msg_type", event->netlink.msg_type);
+	pb_attr_int(rec, 6, "netlink.msg_flags", event->netlink.msg_flags);
+	pb_attr_int(rec, 6, "netlink.seq", event->netlink.seq);
+	pb_attr_int(rec, 6, "netlink.pid", event->netlink.pid);
+	if (event->netlink.netns)
+		pb_attr_int(rec, 6, "netlink.netns", (int64_t)event->netlink.netns);
+	if (event->netlink.genl_family_name[0]) {
+		pb_attr_string(rec, 6, "netlink.genl.family", event->netlink.genl_family_name,
+		               strnlen(event->netlink.genl_family_name,
+		                       sizeof(event->netlink.genl_family_name)));
+		pb_attr_int(rec, 6, "netlink.genl.cmd", event->netlink.genl_cmd);
+	}
+	if (event->sample_weight > 1)
+		pb_attr_int(rec, 6, "nlmon.sample_weight", event->sample_weight);
+	
+	pb_fixed64(rec, 11, unix_ns());
+	pb_message(&exporter->records, 2, rec);
+}
+
+/* Wrap the batch into an ExportLogsServiceRequest and queue it */
+static void seal_logs(struct otlp_exporter *exporter)
+{
+	struct json_buf *body = &exporter->body;
+	size_t scope_logs, resource_logs;
+	
+	if (!exporter->record_count)
+		return;
+	
+	/* ResourceLogs { Resource, ScopeLogs { InstrumentationScope, LogRecord... } } */
+	scope_logs = exporter->scope.len + exporter->records.len;
+	resource_logs = exporter->resource.len + bytes_size(scope_logs);
+	
+	pb_key(body, 1, PB_BYTES);
+	pb_varint(body, resource_logs);
+	json_buf_append(body, exporter->resource.data, exporter->resource.len);
+	pb_key(body, 2, PB_BYTES);
+	pb_varint(body, scope_logs);
+	json_buf_append(body, exporter->scope.data, exporter->scope.len);
+	json_buf_append(body, exporter->records.data, exporter->records.len);
+	
+	body->failed |= exporter->records.failed;
+	if (request_push(exporter, OTLP_LOGS, exporter->record_count))
+		exporter->tail->opened_ns = exporter->first_ns;
+	
+	json_buf_reset(&exporter->records);
+	exporter->record_count = 0;
+}
+
+/* Metrics */
+
+static void pb_packed_doubles(struct json_buf *buf, unsigned int field, const double *values,
+                              unsigned int n)
+{
+	pb_key(buf, field, PB_BYTES);
+	pb_varint(buf, (uint64_t)n * 8);
+	for (unsigned int i = 0; i < n; i++)
+		put_fixed64(buf, double_bits(values[i]));
+}
+
+static void pb_packed_fixed64(struct json_buf *buf, unsigned int field, const uint64_t *values,
+                              unsigned int n)
+{
+	pb_key(buf, field, PB_BYTES);
+	pb_varint(buf, (uint64_t)n * 8);
+	for (unsigned int i = 0; i < n; i++)
+		put_fixed64(buf, values[i]);
+}
+
+/* Append one Metric with a single data point to the collection */
+static void encode_metric(const struct otlp_metric *m, void *ctx)
+{
+	struct otlp_exporter *exporter = ctx;
+	struct json_buf *point = &exporter->scratch[0];
+	struct json_buf *data = &exporter->scratch[1];
+	struct json_buf *metric = &exporter->scratch[2];
+	
+	pb_string(metric, 1, m->name);
+	
+	switch (m->kind) {
+	case OTLP_METRIC_SUM:
+	case OTLP_METRIC_GAUGE:
+		/* NumberDataPoint */
+		pb_label_attrs(point, 7, m->labels);
+		pb_fixed64(point, 2, exporter->start_unix_ns);
+		pb_fixed64(point, 3, exporter->collect_unix_ns);
+		pb_double(point, 4, m->value);
+		pb_message(data, 1, point);
+		if (m->kind == OTLP_METRIC_SUM) {
+			pb_uint(data, 2, TEMPORALITY_CUMULATIVE);
+			pb_uint(data, 3, 1);
+			pb_message(metric, 7, data);
+		} else {
+			pb_message(metric, 5, data);
+		}
+		break;
+	
+	case OTLP_METRIC_HISTOGRAM:
+		/* HistogramDataPoint */
+		pb_label_attrs(point, 9, m->labels);
+		pb_fixed64(point, 2, exporter->start_unix_ns);
+		pb_fixed64(point, 3, exporter->collect_unix_ns);
+		pb_fixed64(point, 4, m->count);
+		pb_double(point, 5, m->sum);
+		if (m->nbuckets) {
+			pb_packed_fixed64(point, 6, m->buckets, m->nbuckets);
+			if (m->nbuckets > 1)
+				pb_packed_doubles(point, 7, m->bounds, m->nbuckets - 1);
+		}
+		pb_message(data, 1, point);
+		pb_uint(data, 2, TEMPORALITY_CUMULATIVE);
+		pb_message(metric, 9, data);
+		break;
+	
+	case OTLP_METRIC_SUMMARY:
+		/* SummaryDataPoint */
+		pb_label_attrs(point, 7, m->labels);
+		pb_fixed64(point, 2, exporter->start_unix_ns);
+		pb_fixed64(point, 3, exporter->collect_unix_ns);
+		pb_fixed64(point, 4, m->count);
+		pb_double(point, 5, m->sum);
+		for (unsigned int i = 0; i < m->nquantiles; i++) {
+			pb_key(point, 6, PB_BYTES);
+			pb_varint(point, 18);
+			pb_double(point, 1, m->quantiles[i]);
+			pb_double(point, 2, m->quantile_values[i]);
+		}
+		pb_message(data, 1, point);
+		pb_message(metric, 11, data);
+		break;
+	}
+	
+	pb_message(&exporter->metrics, 2, metric);
+	exporter->point_count++;
+}
+
+/* Prometheus histograms count cumulatively, OTLP per bucket */
+static void prometheus_metric(const struct prometheus_sample *sample, void *ctx)
+{
+	uint64_t buckets[16];
+	struct otlp_metric m = {
+		.name = sample->name,
+		.labels = sample->labels,
+		.value = sample->value,
+		.count = sample->count,
+		.sum = sample->sum,
+	};
+	
+	switch (sample->type) {
+	case METRIC_TYPE_COUNTER:
+		m.kind = OTLP_METRIC_SUM;
+		break;
+	case METRIC_TYPE_GAUGE:
+		m.kind = OTLP_METRIC_GAUGE;
+		break;
+	case METRIC_TYPE_HISTOGRAM:
+		m.kind = OTLP_METRIC_HISTOGRAM;
+		m.nbuckets = sample->nbuckets < 16 ? sample->nbuckets : 16;
+		for (unsigned int i = 0; i < m.nbuckets; i++)
+			buckets[i] = sample->buckets[i] - (i ? sample->buckets[i - 1] : 0);
+		m.bounds = sample->bounds;
+		m.buckets = buckets;
+		break;
+	case METRIC_TYPE_SUMMARY:
+		m.kind = OTLP_METRIC_SUMMARY;
+		m.quantiles = sample->quantiles;
+		m.quantile_values = sample->quantile_values;
+		m.nquantiles = sample->nquantiles;
+		break;
+	}
+	
+	encode_metric(&m, ctx);
+}
+
+/* Collect every source into an ExportMetricsServiceRequest and queue it */
+static void collect_metrics(struct otlp_exporter *exporter)
+{
+	struct json_buf *body = &exporter->body;
+	size_t scope_metrics, resource_metrics;
+	
+	exporter->collect_unix_ns = unix_ns();
+	if (exporter->config.prometheus)
+		prometheus_exporter_list_metrics(exporter->config.prometheus, prometheus_metric,
+		                                 exporter);
+	if (exporter->config.resource_tracker)
+		otlp_resource_tracker_metrics(exporter->config.resource_tracker, encode_metric,
+		                              exporter);
+	
+	if (exporter->point_count) {
+		/* ResourceMetrics { Resource, ScopeMetrics { InstrumentationScope, Metric... } } */
+		scope_metrics = exporter->scope.len + exporter->metrics.len;
+		resource_metrics = exporter->resource.len + bytes_size(scope_metrics);
+	
+		pb_key(body, 1, PB_BYTES);
+		pb_varint(body, resource_metrics);
+		json_buf_append(body, exporter->resource.data, exporter->resource.len);
+		pb_key(body, 2, PB_BYTES);
+		pb_varint(body, scope_metrics);
+		json_buf_append(body, exporter->scope.data, exporter->scope.len);
+		json_buf_append(body, exporter->metrics.data, exporter->metrics.len);
+	
+		body->failed |= exporter->metrics.failed;
+		request_push(exporter, OTLP_METRICS, exporter->point_count);
+	}
+	
+	json_buf_reset(&exporter->metrics);
+	exporter->point_count = 0;
+}
+
+/* Seal an old batch, collect metrics if due and send what may go */
+static void run_due(struct otlp_exporter *exporter)
+{
+	uint64_t now = now_ns();
+	
+	if (exporter->record_count &&
+	    now - exporter->first_ns >= adaptive_batch_linger_ns(exporter->batcher))
+		seal_logs(exporter);
+	
+	if (exporter->next_metrics_ns && now >= exporter->next_metrics_ns) {
+		collect_metrics(exporter);
+		exporter->next_metrics_ns = now + exporter->config.metrics_interval_ms * 1000000ULL;
+	}
+	
+	pump(exporter, false);
+}
+
+/* Setup */
+
+/* Signal URL under the base endpoint */
+static char *signal_url(const char *endpoint, const char *path)
+{
+	size_t len = strlen(endpoint);
+	char *url;
+	
+	while (len && endpoint[len - 1] == '/')
+		len--;
+	if (asprintf(&url, "%.*s%s", (int)len, endpoint, path) < 0)
+		return NULL;
+	return url;
+}
+
+/* Request headers, the user's "name=value,..." as "name: value" */
+static struct curl_slist *build_headers(const struct otlp_config *config)
+{
+	struct curl_slist *list = NULL, *next;
+	const char *p = config->headers;
+	char line[512];
+	
+	/* No Expect: 100-continue round trip before larger bodies */
+	next = curl_slist_append(list, "Expect:");
+	if (!next)
+		return NULL;
+	list = next;
+	next = curl_slist_append(list, "Content-Type: application/x-protobuf");
+	if (!next)
+		goto fail;
+	list = next;
+	if (config->level >= 0) {
+		next = curl_slist_append(list, "Content-Encoding: gzip");
+		if (!next)
+			goto fail;
+		list = next;
+	}
+	
+	while (p && *p) {
+		size_t len = strcspn(p, ",");
+		const char *eq = memchr(p, '=', len);
+	
+		if (eq && len < sizeof(line) - 2) {
+			snprintf(line, sizeof(line), "%.*s: %.*s", (int)(eq - p), p,
+			         (int)(len - (size_t)(eq - p) - 1), eq + 1);
+			next = curl_slist_append(list, line);
+			if (!next)
+				goto fail;
+			list = next;
+		}
+		p += len;
+		if (*p == ',')
+			p++;
+	}
+	
+	return list;
+
+fail:
+	curl_slist_free_all(list);
+	return NULL;
+}
+
+/* Resource { service.name, host.name } and InstrumentationScope, as fields */
+static void encode_resource(struct otlp_exporter *exporter, const struct otlp_config *config)
+{
+	struct json_buf *attrs = &exporter->scratch[0];
+	const char *service = config->service_name ? config->service_name : "nlmon";
+	char host[256] = "";
+	
+	if (config->node)
+		snprintf(host, sizeof(host), "%s", config->node);
+	else if (gethostname(host, sizeof(host)) == 0)
+		host[sizeof(host) - 1] = '\0';
+	
+	pb_attr_string(attrs, 1, "service.name", service, strlen(service));
+	if (host[0])
+		pb_attr_string(attrs, 1, "host.name", host, strlen(host));
+	pb_message(&exporter->resource, 1, attrs);
+	
+	pb_string(attrs, 1, SCOPE_NAME);
+	pb_message(&exporter->scope, 1, attrs);
+}
+
+static void exporter_free(struct otlp_exporter *exporter)
+{
+	while (exporter->head) {
+		struct otlp_request *req = exporter->head;
+	
+		exporter->head = req->next;
+		free(req);
+	}
+	
+	if (exporter->curl)
+		curl_easy_cleanup(exporter->curl);
+	curl_slist_free_all(exporter->headers);
+	free(exporter->urls[OTLP_LOGS]);
+	free(exporter->urls[OTLP_METRICS]);
+	json_buf_free(&exporter->resource);
+	json_buf_free(&exporter->scope);
+	json_buf_free(&exporter->records);
+	json_buf_free(&exporter->metrics);
+	for (int i = 0; i < 3; i++)
+		json_buf_free(&exporter->scratch[i]);
+	json_buf_free(&exporter->body);
+	free(exporter->zbuf);
+	adaptive_batch_destroy(exporter->batcher);
+	pthread_mutex_destroy(&exporter->lock);
+	free(exporter);
+}
+
+struct otlp_exporter *otlp_exporter_create(const struct otlp_config *config)
+{
+	struct adaptive_batch_config batching = { 0 };
+	struct otlp_exporter *exporter;
+	const char *endpoint;
+	bool ok = true;
+	
+	if (!config)
+		return NULL;
+	
+	exporter = calloc(1, sizeof(*exporter));
+	if (!exporter)
+		return NULL;
+	
+	exporter->config = *config;
+	if (exporter->config.level == 0)
+		exporter->config.level = 1;
+	if (exporter->config.level > 9)
+		exporter->config.level = 9;
+	if (!exporter->config.batch_events)
+		exporter->config.batch_events = OTLP_BATCH_EVENTS;
+	if (!exporter->config.batch_bytes)
+		exporter->config.batch_bytes = OTLP_BATCH_BYTES;
+	if (!exporter->config.batch_delay_ms)
+		exporter->config.batch_delay_ms = OTLP_BATCH_DELAY_MS;
+	if (!exporter->config.timeout_ms)
+		exporter->config.timeout_ms = OTLP_TIMEOUT_MS;
+	if (!exporter->config.retry_initial_ms)
+		exporter->config.retry_initial_ms = OTLP_RETRY_INITIAL_MS;
+	if (!exporter->config.retry_max_ms)
+		exporter->config.retry_max_ms = OTLP_RETRY_MAX_MS;
+	if (!exporter->config.retry_elapsed_ms)
+		exporter->config.retry_elapsed_ms = OTLP_RETRY_ELAPSED_MS;
+	if (!exporter->config.memory_limit)
+		exporter->config.memory_limit = OTLP_MEMORY_DEFAULT;
+	if (!exporter->config.metrics_interval_ms)
+		exporter->config.metrics_interval_ms = OTLP_METRICS_INTERVAL_MS;
+	
+	/* Strings are only used here */
+	endpoint = config->endpoint ? config->endpoint : OTLP_DEFAULT_ENDPOINT;
+	exporter->config.endpoint = NULL;
+	exporter->config.headers = NULL;
+	exporter->config.service_name = NULL;
+	exporter->config.node = NULL;
+	
+	pthread_mutex_init(&exporter->lock, NULL);
+	exporter->seed = (unsigned int)unix_ns();
+	exporter->start_unix_ns = unix_ns();
+	if (config->prometheus || config->resource_tracker)
+		exporter->next_metrics_ns = now_ns() +
+		                            exporter->config.metrics_interval_ms * 1000000ULL;
+	
+	ok &= json_buf_init(&exporter->resource, 256);
+	ok &= json_buf_init(&exporter->scope, 64);
+	ok &= json_buf_init(&exporter->records, exporter->config.batch_bytes + 4096);
+	ok &= json_buf_init(&exporter->metrics, 16384);
+	for (int i = 0; i < 3; i++)
+		ok &= json_buf_init(&exporter->scratch[i], 1024);
+	ok &= json_buf_init(&exporter->body, exporter->config.batch_bytes + 8192);
+	if (!ok)
+		goto fail;
+	
+	batching.max_size = exporter->config.batch_events;
+	batching.target_us = (uint64_t)exporter->config.batch_latency_ms * 1000;
+	batching.max_linger_us = (uint64_t)exporter->config.batch_delay_ms * 1000;
+	exporter->batcher = adaptive_batch_create("otlp", &batching);
+	if (!exporter->batcher)
+		goto fail;
+	
+	encode_resource(exporter, config);
+	if (exporter->resource.failed || exporter->scope.failed)
+		goto fail;
+	
+	exporter->urls[OTLP_LOGS] = signal_url(endpoint, "/v1/logs");
+	exporter->urls[OTLP_METRICS] = signal_url(endpoint, "/v1/metrics");
+	if (!exporter->urls[OTLP_LOGS] || !exporter->urls[OTLP_METRICS])
+		goto fail;
+	
+	exporter->headers = build_headers(config);
+	exporter->curl = curl_easy_init();
+	if (!exporter->headers || !exporter->curl)
+		goto fail;
+	
+	curl_easy_setopt(exporter->curl, CURLOPT_HTTPHEADER, exporter->headers);
+	curl_easy_setopt(exporter->curl, CURLOPT_WRITEFUNCTION, response_discard);
+	curl_easy_setopt(exporter->curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(exporter->curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(exporter->curl, CURLOPT_TIMEOUT_MS, (long)exporter->config.timeout_ms);
+	
+	return exporter;
+
+fail:
+	exporter_free(exporter);
+	return NULL;
+}
+
+void otlp_exporter_destroy(struct otlp_exporter *exporter)
+{
+	if (!exporter)
+		return;
+	
+	seal_logs(exporter);
+	pump(exporter, true);
+	exporter_free(exporter);
+}
+
+bool otlp_exporter_write_event(struct otlp_exporter *exporter, const struct nlmon_event *event)
+{
+	if (!exporter || !event)
+		return false;
+	
+	if (exporter->record_count == 0)
+		exporter->first_ns = now_ns();
+	encode_record(exporter, event);
+	exporter->record_count++;
+	
+	pthread_mutex_lock(&exporter->lock);
+	exporter->stats.events++;
+	pthread_mutex_unlock(&exporter->lock);
+	
+	if (exporter->record_count >= adaptive_batch_size(exporter->batcher) ||
+	    exporter->records.len >= exporter->config.batch_bytes)
+		seal_logs(exporter);
+	run_due(exporter);
+	
+	return true;
+}
+
+void otlp_exporter_tick(struct otlp_exporter *exporter)
+{
+	if (exporter)
+		run_due(exporter);
+}
+
+bool otlp_exporter_flush(struct otlp_exporter *exporter)
+{
+	if (!exporter)
+		return false;
+	
+	seal_logs(exporter);
+	return pump(exporter, true);
+}
+
+void otlp_exporter_get_stats(struct otlp_exporter *exporter, struct otlp_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (!exporter)
+		return;
+	
+	pthread_mutex_lock(&exporter->lock);
+	*stats = exporter->stats;
+	pthread_mutex_unlock(&exporter->lock);
+}
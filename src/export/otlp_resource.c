@@ -0,0 +1,62 @@
+/* otlp_resource.c - Resource tracker metrics as OTLP data points
+ *
+ * Apart from otlp_export.c since resource_tracker.h and
+ * prometheus_exporter.h both define enum metric_type.
+ */
+
+#include "otlp_export.h"
+#include "resource_tracker.h"
+#include <stddef.h>
+
+#define BUCKETS 10
+
+struct resource_walk {
+	otlp_metric_fn fn;
+	void *ctx;
+};
+
+static void resource_metric(const struct metric *m, void *arg)
+{
+	struct resource_walk *walk = arg;
+	uint64_t buckets[BUCKETS];
+	struct otlp_metric metric = {
+		.name = m->name,
+		.labels = m->labels,
+	};
+	
+	switch (m->type) {
+	case METRIC_COUNTER:
+		metric.kind = OTLP_METRIC_SUM;
+		metric.value = (double)m->value.counter;
+		break;
+	case METRIC_GAUGE:
+		metric.kind = OTLP_METRIC_GAUGE;
+		metric.value = m->value.gauge;
+		break;
+	case METRIC_HISTOGRAM:
+		/* The tracker's buckets are cumulative, OTLP's are not */
+		for (int i = 0; i < BUCKETS; i++)
+			buckets[i] = m->value.histogram.buckets[i] -
+			             (i ? m->value.histogram.buckets[i - 1] : 0);
+		metric.kind = OTLP_METRIC_HISTOGRAM;
+		metric.count = m->value.histogram.count;
+		metric.sum = m->value.histogram.sum;
+		metric.bounds = metric_histogram_bounds;
+		metric.buckets = buckets;
+		metric.nbuckets = BUCKETS;
+		break;
+	default:
+		return;
+	}
+	
+	walk->fn(&metric, walk->ctx);
+}
+
+void otlp_resource_tracker_metrics(struct resource_tracker *tracker, otlp_metric_fn fn,
+                                   void *ctx)
+{
+	struct resource_walk walk = { .fn = fn, .ctx = ctx };
+	
+	if (tracker && fn)
+		resource_tracker_list_metrics(tracker, resource_metric, &walk);
+}
@@ -1,14 +1,56 @@
-/* pcap_export.c - Enhanced PCAP export with rotation support */
+/* pcap_export.c - Enhanced PCAP export with rotation support
+ *
+ * Records are built in one buffer and written out with pwrite() once it
+ * is full, so a capture costs a system call per buffer rather than two
+ * stdio writes per packet. Payloads too large to be worth copying are
+ * written straight from the caller with pwritev() behind the buffered
+ * records.
+ *
+ * With O_DIRECT the buffer is page aligned and only whole pages go to
+ * the direct descriptor. On flush the partial page at the end is also
+ * written through an ordinary descriptor; the next direct write covers
+ * the same offset again with the page completed.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 
 #include "pcap_export.h"
+#include "file_compress.h"
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <fcntl.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <unistd.h>
 
+/* Alignment of O_DIRECT buffers, offsets and lengths */
+#define PCAP_DIRECT_ALIGN 4096
+
+/* Link type of the records */
+#define LINKTYPE_NETLINK 253
+
+/* pcapng block types and options */
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_SHB_USERAPPL 4
+#define PCAPNG_IF_NAME 2
+#define PCAPNG_IF_TSRESOL 9
+
+/* Longest packet comment, longer ones are cut */
+#define PCAPNG_MAX_COMMENT 1024
+
+/* Interface 0 of every pcapng file, for packets without an interface */
+#define PCAPNG_CAPTURE_INTERFACE "nlmon"
+
 /* PCAP file format structures */
 struct pcap_file_header {
 	uint32_t magic_number;   /* magic number */
@@ -27,11 +69,35 @@ struct pcap_packet_header {
 	uint32_t orig_len;       /* actual length of packet */
 };
 
+/* pcapng Enhanced Packet Block, up to the packet data */
+struct pcapng_epb_header {
+	uint32_t block_type;
+	uint32_t block_total_length;
+	uint32_t interface_id;
+	uint32_t timestamp_high;
+	uint32_t timestamp_low;
+	uint32_t captured_len;
+	uint32_t original_len;
+};
+
 struct pcap_exporter {
 	char *base_filename;
-	FILE *fp;
+	int fd;                  /* Current file */
+	int direct_fd;           /* Same file opened O_DIRECT, -1 if not in use */
 	struct pcap_rotation_policy policy;
 	bool has_policy;
+	struct file_compressor *compressor;  /* Set when rotated files are compressed */
+	struct pcap_export_options options;
+	
+	/* Records not yet written, buf[0] belongs at file offset buf_offset */
+	unsigned char *buf;
+	size_t buf_len;
+	size_t buf_size;
+	off_t buf_offset;
+	
+	/* Interfaces described in the current pcapng file, by interface ID */
+	char interfaces[PCAP_MAX_INTERFACES][16];
+	uint32_t interface_count;
 	
 	/* Statistics */
 	uint64_t packets_written;
@@ -40,7 +106,220 @@ struct pcap_exporter {
 	uint32_t rotations;
 };
 
-static bool write_pcap_header(FILE *fp)
+static size_t pad4(size_t len)
+{
+	return (len + 3) & ~(size_t)3;
+}
+
+/* Write every byte of iov at offset, false on error */
+static bool pwritev_all(int fd, struct iovec *iov, int iovcnt, off_t offset)
+{
+	while (iovcnt > 0) {
+		ssize_t n = pwritev(fd, iov, iovcnt, offset);
+		
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		offset += n;
+		
+		/* Step past what was written */
+		while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (unsigned char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	
+	return true;
+}
+
+static bool pwrite_all(int fd, const void *data, size_t len, off_t offset)
+{
+	struct iovec iov = { .iov_base = (void *)data, .iov_len = len };
+	
+	return pwritev_all(fd, &iov, 1, offset);
+}
+
+/* Write out buffered records, all of them or only whole direct pages */
+static bool flush_buffer(struct pcap_exporter *exporter, bool all)
+{
+	size_t aligned;
+	
+	if (exporter->buf_len == 0)
+		return true;
+	
+	if (exporter->direct_fd < 0) {
+		if (!pwrite_all(exporter->fd, exporter->buf, exporter->buf_len, exporter->buf_offset))
+			return false;
+		exporter->buf_offset += exporter->buf_len;
+		exporter->buf_len = 0;
+		return true;
+	}
+	
+	aligned = exporter->buf_len & ~(size_t)(PCAP_DIRECT_ALIGN - 1);
+	if (aligned > 0) {
+		if (!pwrite_all(exporter->direct_fd, exporter->buf, aligned, exporter->buf_offset))
+			return false;
+		memmove(exporter->buf, exporter->buf + aligned, exporter->buf_len - aligned);
+		exporter->buf_offset += aligned;
+		exporter->buf_len -= aligned;
+	}
+	
+	/* The partial page stays buffered for the next direct write */
+	if (all && exporter->buf_len > 0)
+		return pwrite_all(exporter->fd, exporter->buf, exporter->buf_len, exporter->buf_offset);
+	
+	return true;
+}
+
+/* Append bytes to the buffer, writing it out whenever it fills */
+static bool buffer_append(struct pcap_exporter *exporter, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	
+	while (len > 0) {
+		size_t space = exporter->buf_size - exporter->buf_len;
+		size_t n = len < space ? len : space;
+		
+		memcpy(exporter->buf + exporter->buf_len, p, n);
+		exporter->buf_len += n;
+		p += n;
+		len -= n;
+		
+		if (exporter->buf_len == exporter->buf_size && !flush_buffer(exporter, false))
+			return false;
+	}
+	
+	return true;
+}
+
+/* Write the buffered records and then a record from pieces, in one call */
+static bool write_through(struct pcap_exporter *exporter, struct iovec *record, int count)
+{
+	struct iovec iov[4];
+	size_t total = exporter->buf_len;
+	int i;
+	
+	iov[0].iov_base = exporter->buf;
+	iov[0].iov_len = exporter->buf_len;
+	for (i = 0; i < count; i++) {
+		iov[i + 1] = record[i];
+		total += record[i].iov_len;
+	}
+	
+	if (!pwritev_all(exporter->fd, iov, count + 1, exporter->buf_offset))
+		return false;
+	
+	exporter->buf_offset += total;
+	exporter->buf_len = 0;
+	return true;
+}
+
+/*
+ * Add a record made of pieces. Large payloads skip the copy into the
+ * buffer unless O_DIRECT needs every byte to pass through it.
+ */
+static bool write_record(struct pcap_exporter *exporter, struct iovec *record, int count,
+                         size_t payload_len)
+{
+	int i;
+	
+	if (exporter->direct_fd < 0 && payload_len >= exporter->buf_size / 2)
+		return write_through(exporter, record, count);
+	
+	for (i = 0; i < count; i++) {
+		if (!buffer_append(exporter, record[i].iov_base, record[i].iov_len))
+			return false;
+	}
+	
+	return true;
+}
+
+/* Append a pcapng option to p, returns the bytes used */
+static size_t put_option(unsigned char *p, uint16_t code, const void *value, size_t len)
+{
+	uint16_t header[2] = { code, (uint16_t)len };
+	
+	memcpy(p, header, sizeof(header));
+	memcpy(p + sizeof(header), value, len);
+	memset(p + sizeof(header) + len, 0, pad4(len) - len);
+	
+	return sizeof(header) + pad4(len);
+}
+
+/* Append an end of options marker and the trailing length, returns the bytes used */
+static size_t put_trailer(unsigned char *p, uint32_t total_length)
+{
+	uint32_t end = PCAPNG_OPT_END;
+	
+	memcpy(p, &end, sizeof(end));
+	memcpy(p + sizeof(end), &total_length, sizeof(total_length));
+	
+	return sizeof(end) + sizeof(total_length);
+}
+
+/* Add an Interface Description Block, returns its interface ID in id */
+static bool write_idb(struct pcap_exporter *exporter, const char *name, uint32_t *id)
+{
+	unsigned char block[64];
+	uint32_t words[4];
+	uint8_t tsresol = 9;           /* Nanoseconds */
+	size_t name_len = strnlen(name, sizeof(exporter->interfaces[0]) - 1);
+	size_t len = 16;
+	
+	len += put_option(block + len, PCAPNG_IF_NAME, name, name_len);
+	len += put_option(block + len, PCAPNG_IF_TSRESOL, &tsresol, 1);
+	len += 8;
+	
+	words[0] = PCAPNG_IDB;
+	words[1] = len;
+	words[2] = LINKTYPE_NETLINK;   /* Link type, then reserved */
+	words[3] = 0;                  /* No snapshot length limit */
+	memcpy(block, words, sizeof(words));
+	put_trailer(block + len - 8, len);
+	
+	if (!buffer_append(exporter, block, len))
+		return false;
+	
+	*id = exporter->interface_count;
+	memcpy(exporter->interfaces[*id], name, name_len);
+	exporter->interfaces[*id][name_len] = '\0';
+	exporter->interface_count++;
+	exporter->current_file_size += len;
+	
+	return true;
+}
+
+/* Find the interface ID of name, describing the interface on first use */
+static bool interface_id(struct pcap_exporter *exporter, const char *name, uint32_t *id)
+{
+	uint32_t i;
+	
+	if (!name || !name[0])
+		name = PCAPNG_CAPTURE_INTERFACE;
+	
+	for (i = 0; i < exporter->interface_count; i++) {
+		if (strncmp(exporter->interfaces[i], name, sizeof(exporter->interfaces[i]) - 1) == 0) {
+			*id = i;
+			return true;
+		}
+	}
+	
+	if (exporter->interface_count == PCAP_MAX_INTERFACES) {
+		*id = 0;
+		return true;
+	}
+	
+	return write_idb(exporter, name, id);
+}
+
+static bool write_pcap_header(struct pcap_exporter *exporter)
 {
 	struct pcap_file_header fh;
 	
@@ -50,14 +329,84 @@ static bool write_pcap_header(FILE *fp)
 	fh.thiszone = 0;
 	fh.sigfigs = 0;
 	fh.snaplen = 65535;
-	fh.network = 253;  /* DLT_NETLINK for netlink messages */
+	fh.network = LINKTYPE_NETLINK;  /* DLT_NETLINK for netlink messages */
 	
-	if (fwrite(&fh, sizeof(fh), 1, fp) != 1)
+	if (!buffer_append(exporter, &fh, sizeof(fh)))
 		return false;
 	
+	exporter->current_file_size = sizeof(fh);
 	return true;
 }
 
+/* Section Header Block and the capture interface */
+static bool write_pcapng_header(struct pcap_exporter *exporter)
+{
+	static const char application[] = "nlmon";
+	unsigned char block[64];
+	uint32_t words[3] = { PCAPNG_SHB, 0, PCAPNG_BYTE_ORDER_MAGIC };
+	uint16_t version[2] = { 1, 0 };
+	int64_t section_length = -1;   /* Not known in advance */
+	uint32_t id;
+	size_t len = 24;
+	
+	len += put_option(block + len, PCAPNG_SHB_USERAPPL, application, sizeof(application) - 1);
+	len += 8;
+	
+	words[1] = len;
+	memcpy(block, words, sizeof(words));
+	memcpy(block + 12, version, sizeof(version));
+	memcpy(block + 16, &section_length, sizeof(section_length));
+	put_trailer(block + len - 8, len);
+	
+	if (!buffer_append(exporter, block, len))
+		return false;
+	
+	exporter->current_file_size = len;
+	exporter->interface_count = 0;
+	
+	return write_idb(exporter, PCAPNG_CAPTURE_INTERFACE, &id);
+}
+
+/* Open base_filename for a new file and start it with the file header */
+static bool open_file(struct pcap_exporter *exporter)
+{
+	exporter->fd = open(exporter->base_filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (exporter->fd < 0)
+		return false;
+	
+	/* File systems without O_DIRECT get ordinary writes */
+	exporter->direct_fd = -1;
+	if (exporter->options.direct_io)
+		exporter->direct_fd = open(exporter->base_filename, O_WRONLY | O_DIRECT | O_CLOEXEC);
+	
+	exporter->buf_len = 0;
+	exporter->buf_offset = 0;
+	
+	if (exporter->options.format == PCAP_FORMAT_PCAPNG)
+		return write_pcapng_header(exporter);
+	return write_pcap_header(exporter);
+}
+
+static bool close_file(struct pcap_exporter *exporter)
+{
+	bool ok = true;
+	
+	if (exporter->fd < 0)
+		return true;
+	
+	if (!flush_buffer(exporter, true))
+		ok = false;
+	
+	if (exporter->direct_fd >= 0)
+		close(exporter->direct_fd);
+	if (close(exporter->fd) < 0)
+		ok = false;
+	
+	exporter->fd = -1;
+	exporter->direct_fd = -1;
+	return ok;
+}
+
 static char *generate_rotated_filename(const char *base, uint32_t rotation)
 {
 	char *filename;
@@ -71,28 +420,16 @@ static char *generate_rotated_filename(const char *base, uint32_t rotation)
 	return filename;
 }
 
-static bool compress_file(const char *filename)
-{
-	char cmd[1024];
-	int ret;
-	
-	/* Use gzip to compress the file */
-	snprintf(cmd, sizeof(cmd), "gzip -f '%s' 2>/dev/null", filename);
-	ret = system(cmd);
-	
-	return ret == 0;
-}
-
 static bool rotate_files(struct pcap_exporter *exporter)
 {
 	char *old_name, *new_name;
 	uint32_t i;
 	
 	/* Close current file */
-	if (exporter->fp) {
-		fclose(exporter->fp);
-		exporter->fp = NULL;
-	}
+	close_file(exporter);
+	
+	/* Nothing may be renamed while it is being compressed */
+	file_compressor_wait(exporter->compressor);
 	
 	/* Delete oldest rotation if we've hit the limit */
 	if (exporter->policy.max_rotations > 0) {
@@ -142,25 +479,18 @@ static bool rotate_files(struct pcap_exporter *exporter)
 		rename(exporter->base_filename, old_name);
 		
 		/* Compress if requested */
-		if (exporter->policy.compress_rotated) {
-			compress_file(old_name);
-		}
+		if (exporter->compressor)
+			file_compressor_submit(exporter->compressor, old_name);
 		
 		free(old_name);
 	}
 	
 	/* Open new file */
-	exporter->fp = fopen(exporter->base_filename, "wb");
-	if (!exporter->fp)
-		return false;
-	
-	if (!write_pcap_header(exporter->fp)) {
-		fclose(exporter->fp);
-		exporter->fp = NULL;
+	if (!open_file(exporter)) {
+		close_file(exporter);
 		return false;
 	}
 	
-	exporter->current_file_size = sizeof(struct pcap_file_header);
 	exporter->rotations++;
 	
 	return true;
@@ -168,6 +498,13 @@ static bool rotate_files(struct pcap_exporter *exporter)
 
 struct pcap_exporter *pcap_exporter_create(const char *base_filename,
                                            struct pcap_rotation_policy *policy)
+{
+	return pcap_exporter_create_with_options(base_filename, policy, NULL);
+}
+
+struct pcap_exporter *pcap_exporter_create_with_options(const char *base_filename,
+                                                        struct pcap_rotation_policy *policy,
+                                                        const struct pcap_export_options *options)
 {
 	struct pcap_exporter *exporter;
 	
@@ -178,35 +515,56 @@ struct pcap_exporter *pcap_exporter_create(const char *base_filename,
 	if (!exporter)
 		return NULL;
 	
+	exporter->fd = -1;
+	exporter->direct_fd = -1;
+	
 	exporter->base_filename = strdup(base_filename);
-	if (!exporter->base_filename) {
-		free(exporter);
-		return NULL;
-	}
+	if (!exporter->base_filename)
+		goto err_free;
 	
 	if (policy) {
 		exporter->policy = *policy;
 		exporter->has_policy = true;
 	}
 	
-	/* Open initial file */
-	exporter->fp = fopen(base_filename, "wb");
-	if (!exporter->fp) {
-		free(exporter->base_filename);
-		free(exporter);
-		return NULL;
+	if (options)
+		exporter->options = *options;
+	
+	/* Whole pages, so O_DIRECT can write any full buffer */
+	exporter->buf_size = exporter->options.buffer_size ? exporter->options.buffer_size :
+	                     PCAP_EXPORT_BUFFER_SIZE;
+	exporter->buf_size = (exporter->buf_size + PCAP_DIRECT_ALIGN - 1) &
+	                     ~(size_t)(PCAP_DIRECT_ALIGN - 1);
+	if (posix_memalign((void **)&exporter->buf, PCAP_DIRECT_ALIGN, exporter->buf_size) != 0) {
+		exporter->buf = NULL;
+		goto err_name;
 	}
 	
-	if (!write_pcap_header(exporter->fp)) {
-		fclose(exporter->fp);
-		free(exporter->base_filename);
-		free(exporter);
-		return NULL;
+	/* Open initial file */
+	if (!open_file(exporter))
+		goto err_file;
+	
+	if (policy && policy->compress_rotated) {
+		struct file_compress_config compress_config = {
+			.level = policy->compress_level,
+			.threads = policy->compress_threads
+		};
+		
+		exporter->compressor = file_compressor_create(&compress_config);
+		if (!exporter->compressor)
+			goto err_file;
 	}
 	
-	exporter->current_file_size = sizeof(struct pcap_file_header);
-	
 	return exporter;
+	
+err_file:
+	close_file(exporter);
+	free(exporter->buf);
+err_name:
+	free(exporter->base_filename);
+err_free:
+	free(exporter);
+	return NULL;
 }
 
 void pcap_exporter_destroy(struct pcap_exporter *exporter)
@@ -214,34 +572,113 @@ void pcap_exporter_destroy(struct pcap_exporter *exporter)
 	if (!exporter)
 		return;
 	
-	if (exporter->fp) {
-		fflush(exporter->fp);
-		fclose(exporter->fp);
-	}
+	close_file(exporter);
 	
+	/* Finishes the last rotated file */
+	file_compressor_destroy(exporter->compressor);
+	
+	free(exporter->buf);
 	free(exporter->base_filename);
 	free(exporter);
 }
 
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool write_pcap_record(struct pcap_exporter *exporter, const unsigned char *data,
+                              size_t len, uint64_t timestamp_ns)
+{
+	struct pcap_packet_header ph;
+	struct iovec record[2];
+	
+	ph.ts_sec = timestamp_ns / 1000000000ULL;
+	ph.ts_usec = (timestamp_ns % 1000000000ULL) / 1000;
+	ph.incl_len = len;
+	ph.orig_len = len;
+	
+	record[0].iov_base = &ph;
+	record[0].iov_len = sizeof(ph);
+	record[1].iov_base = (void *)data;
+	record[1].iov_len = len;
+	
+	if (!write_record(exporter, record, 2, len))
+		return false;
+	
+	exporter->current_file_size += sizeof(ph) + len;
+	return true;
+}
+
+static bool write_pcapng_record(struct pcap_exporter *exporter, const unsigned char *data,
+                                size_t len, uint64_t timestamp_ns, uint32_t id,
+                                const char *comment)
+{
+	unsigned char tail[3 + 4 + PCAPNG_MAX_COMMENT + 8];
+	struct pcapng_epb_header epb;
+	struct iovec record[3];
+	size_t comment_len = comment ? strnlen(comment, PCAPNG_MAX_COMMENT) : 0;
+	size_t pad = pad4(len) - len;
+	size_t tail_len = pad;
+	size_t total;
+	
+	/* Padding of the data, the comment, then end of options and length */
+	memset(tail, 0, pad);
+	if (comment_len)
+		tail_len += put_option(tail + tail_len, PCAPNG_OPT_COMMENT, comment, comment_len);
+	total = sizeof(epb) + len + tail_len + 8;
+	tail_len += put_trailer(tail + tail_len, total);
+	
+	epb.block_type = PCAPNG_EPB;
+	epb.block_total_length = total;
+	epb.interface_id = id;
+	epb.timestamp_high = timestamp_ns >> 32;
+	epb.timestamp_low = (uint32_t)timestamp_ns;
+	epb.captured_len = len;
+	epb.original_len = len;
+	
+	record[0].iov_base = &epb;
+	record[0].iov_len = sizeof(epb);
+	record[1].iov_base = (void *)data;
+	record[1].iov_len = len;
+	record[2].iov_base = tail;
+	record[2].iov_len = tail_len;
+	
+	if (!write_record(exporter, record, 3, len))
+		return false;
+	
+	exporter->current_file_size += total;
+	return true;
+}
+
 bool pcap_exporter_write_packet(struct pcap_exporter *exporter,
                                 const unsigned char *data,
                                 size_t len)
 {
-	struct pcap_packet_header ph;
-	struct timeval tv;
+	return pcap_exporter_write_packet_info(exporter, data, len, NULL);
+}
+
+bool pcap_exporter_write_packet_info(struct pcap_exporter *exporter,
+                                     const unsigned char *data,
+                                     size_t len,
+                                     const struct pcap_packet_info *info)
+{
+	uint64_t timestamp_ns;
 	size_t packet_size;
+	uint32_t id = 0;
+	bool pcapng;
+	bool ok;
 	
-	if (!exporter || !exporter->fp || !data)
+	if (!exporter || exporter->fd < 0 || !data)
 		return false;
 	
-	gettimeofday(&tv, NULL);
-	
-	ph.ts_sec = tv.tv_sec;
-	ph.ts_usec = tv.tv_usec;
-	ph.incl_len = len;
-	ph.orig_len = len;
-	
-	packet_size = sizeof(ph) + len;
+	timestamp_ns = info && info->timestamp_ns ? info->timestamp_ns : now_ns();
+	pcapng = exporter->options.format == PCAP_FORMAT_PCAPNG;
+	packet_size = pcapng ? sizeof(struct pcapng_epb_header) + pad4(len) + 12 :
+	                       sizeof(struct pcap_packet_header) + len;
 	
 	/* Check if rotation is needed */
 	if (exporter->has_policy && exporter->policy.max_file_size > 0) {
@@ -251,27 +688,30 @@ bool pcap_exporter_write_packet(struct pcap_exporter *exporter,
 		}
 	}
 	
-	/* Write packet header */
-	if (fwrite(&ph, sizeof(ph), 1, exporter->fp) != 1)
-		return false;
+	if (pcapng) {
+		if (!interface_id(exporter, info ? info->interface : NULL, &id))
+			return false;
+		ok = write_pcapng_record(exporter, data, len, timestamp_ns, id,
+		                         info ? info->comment : NULL);
+	} else {
+		ok = write_pcap_record(exporter, data, len, timestamp_ns);
+	}
 	
-	/* Write packet data */
-	if (fwrite(data, 1, len, exporter->fp) != len)
+	if (!ok)
 		return false;
 	
 	exporter->packets_written++;
 	exporter->bytes_written += len;
-	exporter->current_file_size += packet_size;
 	
 	return true;
 }
 
 bool pcap_exporter_flush(struct pcap_exporter *exporter)
 {
-	if (!exporter || !exporter->fp)
+	if (!exporter || exporter->fd < 0)
 		return false;
 	
-	return fflush(exporter->fp) == 0;
+	return flush_buffer(exporter, true);
 }
 
 bool pcap_exporter_get_stats(struct pcap_exporter *exporter,
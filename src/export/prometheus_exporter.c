@@ -1,275 +1,1537 @@
-/* prometheus_exporter.c - Prometheus metrics exporter */
+/* prometheus_exporter.c - Prometheus metrics exporter
+ *
+ * Metrics live in an open addressing hash table of pointers. A metric is
+ * filled in before its pointer is published with a release store, and
+ * metrics are only freed with the exporter, so lookups walk the table
+ * without a lock and callers can keep the pointer as a handle. The lock
+ * only serializes registration.
+ *
+ * Each thread picks one of PROM_SHARDS cache line aligned slots the
+ * first time it updates a metric, so threads rarely write the same line.
+ * The HTTP thread sums the slots while it formats the response, which it
+ * keeps and resends until the cache interval has passed. Text and
+ * protobuf responses are cached separately.
+ *
+ * The protobuf format is the delimited MetricFamily stream of the
+ * Prometheus client data model, written by hand since only a few
+ * message types are needed.
+ *
+ * The HTTP thread runs an epoll loop over non-blocking sockets, so a
+ * slow scraper only holds its own connection. Connections are kept
+ * alive between scrapes and share the cached bodies by reference count,
+ * a gzip copy of which is made once per body when a scraper accepts it.
+ *
+ * Cardinality limits are applied in two places. Registration hands out
+ * the overflow series once a name has max_series, and before a response
+ * is generated a governance pass notes each series' progress since the
+ * last one and has the governor decide which series are shown. Folded
+ * series are summed into the overflow series while formatting, histograms
+ * through a scratch HDR histogram.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 
 #include "prometheus_exporter.h"
+#include "thread_affinity.h"
+#include "json_buf.h"
+#include "export_layer.h"
+#include "stats_bus.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdatomic.h>
 #include <pthread.h>
+#include <strings.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <time.h>
 #include <errno.h>
 #include <math.h>
+#include <zlib.h>
 
 #define MAX_METRICS 1024
 #define MAX_METRIC_NAME 128
 #define MAX_METRIC_LABELS 256
-#define RESPONSE_BUFFER_SIZE 65536
+#define HISTOGRAM_BUCKETS 10
+#define SUMMARY_QUANTILES 4
+
+/* Hash table slots, a power of two at least twice MAX_METRICS */
+#define INDEX_SLOTS 2048
+
+/* Update slots per counter or histogram */
+#define PROM_SHARDS 8
+
+/* Names of the gauges reporting cardinality, never governed themselves */
+#define GOVERNANCE_PREFIX "nlmon_metric_series"
+
+/* One thread shard's part of a counter or histogram */
+struct metric_shard {
+	_Atomic uint64_t count;                 /* Counter value or observations */
+	_Atomic uint64_t sum;                   /* Bits of the histogram sum */
+	_Atomic uint64_t buckets[HISTOGRAM_BUCKETS];
+} __attribute__((aligned(64)));
+
+struct prometheus_metric {
+	struct metric_shard shards[PROM_SHARDS];
+	_Atomic uint64_t gauge;                 /* Bits of the gauge value */
+	struct hdr_histogram *hdr;              /* Histograms and summaries */
+	enum metric_type type;
+	uint32_t hash;
+	uint32_t name_hash;
+	bool overflow;                          /* Takes series the limits keep out */
+	struct cardinality_series activity;     /* Only used by the HTTP thread */
+	char name[MAX_METRIC_NAME];
+	char labels[MAX_METRIC_LABELS];
+};
+
+/* Values of a series as scraped, folded series added in */
+struct metric_values {
+	uint64_t count;                         /* Counter value or observations */
+	double value;                           /* Gauge value or histogram sum */
+	uint64_t buckets[HISTOGRAM_BUCKETS];
+	const struct hdr_histogram *hdr;
+};
+
+/* Exposition formats */
+enum scrape_format {
+	SCRAPE_TEXT,
+	SCRAPE_PROTOBUF,
+	SCRAPE_FORMATS
+};
+
+/* Response body shared by the cache and the connections sending it */
+struct scrape_body {
+	unsigned int refs;
+	size_t len;
+	char data[];
+};
+
+/* Cached response of one format */
+struct scrape_response {
+	struct scrape_body *plain;
+	struct scrape_body *gzip;               /* Made on the first gzip request */
+	uint64_t time_ms;
+};
+
+/* Scrape connections */
+#define MAX_CONNECTIONS 64
+#define MAX_EVENTS 32
+#define LISTEN_BACKLOG 64
+#define IDLE_TIMEOUT_MS 30000
+#define GZIP_LEVEL 6
+
+/* Client connection, owned by the HTTP thread */
+struct http_conn {
+	int fd;
+	unsigned int slot;
+	uint32_t events;                        /* Events epoll watches */
+	uint64_t active_ms;                     /* Last read or write */
+	bool keep_alive;
+	bool sending;
+	bool metrics;                           /* Response is a scrape */
+	
+	/* Buffered requests */
+	char request[4096];
+	size_t request_len;
+	
+	/* Response being sent */
+	char header[384];
+	size_t header_len;
+	struct scrape_body *body;
+	size_t sent;
+};
+
+/* Nesting levels of protobuf messages below a family */
+#define PB_DEPTH 5
+
+/* epoll tags of the listening socket and the wakeup eventfd */
+#define LISTEN_TAG ((struct http_conn *)&listen_tag)
+#define WAKE_TAG ((struct http_conn *)&wake_tag)
+static const char listen_tag, wake_tag;
+
+struct prometheus_exporter {
+	int listen_sock;
+	int epoll_fd;
+	int wake_fd;
+	uint16_t port;
+	char *path;
+	pthread_t thread;
+	atomic_bool running;
+	
+	/* Open connections */
+	struct http_conn *conns[MAX_CONNECTIONS];
+	unsigned int conn_count;
+	
+	/* Metrics in registration order and their hash index */
+	struct prometheus_metric *metrics[MAX_METRICS];
+	_Atomic unsigned int metric_count;
+	_Atomic(struct prometheus_metric *) index[INDEX_SLOTS];
+	pthread_mutex_t metrics_lock;           /* Serializes registration */
+	struct cardinality_governor *governor;
+	
+	/* Last scrape responses and build buffers, only used by the HTTP thread */
+	struct scrape_response responses[SCRAPE_FORMATS];
+	struct json_buf build;
+	struct json_buf scratch[PB_DEPTH];
+	struct hdr_histogram *fold_hdr;         /* Sum of folded histograms */
+	_Atomic unsigned int cache_interval_ms;
+	
+	/* Statistics, written by the HTTP thread */
+	_Atomic uint64_t requests_served;
+	_Atomic uint64_t last_scrape_time;
+	
+	/* System metrics */
+	double cpu_usage;
+	uint64_t memory_rss;
+	uint64_t memory_vms;
+};
+
+static const double histogram_buckets[HISTOGRAM_BUCKETS] = {
+	0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1.0, 5.0, 10.0, +INFINITY
+};
+
+static const char *const bucket_labels[HISTOGRAM_BUCKETS] = {
+	"0.001", "0.005", "0.010", "0.050", "0.100",
+	"0.500", "1.000", "5.000", "10.000", "+Inf"
+};
+
+static const double summary_quantiles[SUMMARY_QUANTILES] = {
+	0.5, 0.9, 0.99, 0.999
+};
+
+static const char *const quantile_labels[SUMMARY_QUANTILES] = {
+	"0.5", "0.9", "0.99", "0.999"
+};
+
+static const char *const content_types[SCRAPE_FORMATS] = {
+	[SCRAPE_TEXT] = "text/plain; version=0.0.4",
+	[SCRAPE_PROTOBUF] = "application/vnd.google.protobuf; "
+	                    "proto=io.prometheus.client.MetricFamily; encoding=delimited",
+};
+
+static _Atomic unsigned int next_shard;
+static __thread unsigned int thread_shard = PROM_SHARDS;
+
+static inline unsigned int current_shard(void)
+{
+	if (thread_shard == PROM_SHARDS)
+		thread_shard = atomic_fetch_add_explicit(&next_shard, 1,
+		                                         memory_order_relaxed) % PROM_SHARDS;
+	return thread_shard;
+}
+
+static inline uint64_t double_bits(double value)
+{
+	uint64_t bits;
+	
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static inline double bits_double(uint64_t bits)
+{
+	double value;
+	
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static uint64_t monotonic_ms(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* FNV-1a, continued from hash */
+static uint32_t hash_string(uint32_t hash, const char *str)
+{
+	while (*str) {
+		hash ^= (unsigned char)*str++;
+		hash *= 16777619u;
+	}
+	
+	return hash;
+}
+
+static struct prometheus_metric *lookup_metric(struct prometheus_exporter *exporter,
+                                               const char *name,
+                                               const char *labels,
+                                               uint32_t hash)
+{
+	unsigned int i;
+	
+	for (i = 0; i < INDEX_SLOTS; i++) {
+		unsigned int slot = (hash + i) & (INDEX_SLOTS - 1);
+		struct prometheus_metric *metric;
+		
+		metric = atomic_load_explicit(&exporter->index[slot], memory_order_acquire);
+		if (!metric)
+			return NULL;
+		
+		if (metric->hash == hash &&
+		    strcmp(metric->name, name) == 0 &&
+		    strcmp(metric->labels, labels) == 0)
+			return metric;
+	}
+	
+	return NULL;
+}
+
+static struct prometheus_metric *create_metric(struct prometheus_exporter *exporter,
+                                               const char *name,
+                                               const char *labels,
+                                               uint32_t name_hash,
+                                               uint32_t hash,
+                                               enum metric_type type,
+                                               int schema)
+{
+	struct prometheus_metric *metric;
+	unsigned int count, slot;
+	
+	count = atomic_load_explicit(&exporter->metric_count, memory_order_relaxed);
+	if (count >= MAX_METRICS)
+		return NULL;
+	
+	if (posix_memalign((void **)&metric, 64, sizeof(*metric)) != 0)
+		return NULL;
+	
+	memset(metric, 0, sizeof(*metric));
+	strcpy(metric->name, name);
+	strcpy(metric->labels, labels);
+	metric->type = type;
+	metric->hash = hash;
+	metric->name_hash = name_hash;
+	metric->overflow = strcmp(labels, CARDINALITY_OVERFLOW_LABELS) == 0;
+	cardinality_series_init(&metric->activity, monotonic_ms());
+	
+	if (type == METRIC_TYPE_HISTOGRAM || type == METRIC_TYPE_SUMMARY) {
+		metric->hdr = hdr_histogram_create(schema);
+		if (!metric->hdr) {
+			free(metric);
+			return NULL;
+		}
+	}
+	
+	/* The table is never more than half full, an empty slot exists */
+	slot = hash & (INDEX_SLOTS - 1);
+	while (atomic_load_explicit(&exporter->index[slot], memory_order_relaxed))
+		slot = (slot + 1) & (INDEX_SLOTS - 1);
+	
+	exporter->metrics[count] = metric;
+	atomic_store_explicit(&exporter->metric_count, count + 1, memory_order_release);
+	atomic_store_explicit(&exporter->index[slot], metric, memory_order_release);
+	return metric;
+}
+
+static inline bool is_governance(const char *name)
+{
+	return strncmp(name, GOVERNANCE_PREFIX, sizeof(GOVERNANCE_PREFIX) - 1) == 0;
+}
+
+static inline uint32_t labels_hash(uint32_t name_hash, const char *labels)
+{
+	/* Hash name and labels with a separator no name contains */
+	return hash_string((name_hash ^ 0xff) * 16777619u, labels);
+}
+
+/* Find or create the overflow series of a name, with the lock held */
+static struct prometheus_metric *overflow_metric(struct prometheus_exporter *exporter,
+                                                 const char *name,
+                                                 uint32_t name_hash,
+                                                 enum metric_type type,
+                                                 int schema)
+{
+	uint32_t hash = labels_hash(name_hash, CARDINALITY_OVERFLOW_LABELS);
+	struct prometheus_metric *metric;
+	
+	metric = lookup_metric(exporter, name, CARDINALITY_OVERFLOW_LABELS, hash);
+	if (!metric)
+		metric = create_metric(exporter, name, CARDINALITY_OVERFLOW_LABELS,
+		                       name_hash, hash, type, schema);
+	return metric;
+}
+
+/* Create a new series or its name's overflow series, with the lock held */
+static struct prometheus_metric *admit_metric(struct prometheus_exporter *exporter,
+                                              const char *name,
+                                              const char *labels,
+                                              uint32_t name_hash,
+                                              uint32_t hash,
+                                              enum metric_type type,
+                                              int schema)
+{
+	if (!is_governance(name) && strcmp(labels, CARDINALITY_OVERFLOW_LABELS) != 0 &&
+	    !cardinality_governor_admit(exporter->governor, name))
+		return overflow_metric(exporter, name, name_hash, type, schema);
+	
+	return create_metric(exporter, name, labels, name_hash, hash, type, schema);
+}
+
+static struct prometheus_metric *register_metric(struct prometheus_exporter *exporter,
+                                                 const char *name,
+                                                 const char *labels,
+                                                 enum metric_type type,
+                                                 int schema)
+{
+	struct prometheus_metric *metric;
+	uint32_t name_hash, hash;
+	
+	if (!exporter || !name)
+		return NULL;
+	
+	if (!labels)
+		labels = "";
+	
+	if (strlen(name) >= MAX_METRIC_NAME || strlen(labels) >= MAX_METRIC_LABELS)
+		return NULL;
+	
+	name_hash = hash_string(2166136261u, name);
+	hash = labels_hash(name_hash, labels);
+	
+	metric = lookup_metric(exporter, name, labels, hash);
+	if (!metric) {
+		pthread_mutex_lock(&exporter->metrics_lock);
+		metric = lookup_metric(exporter, name, labels, hash);
+		if (!metric)
+			metric = admit_metric(exporter, name, labels, name_hash, hash, type, schema);
+		pthread_mutex_unlock(&exporter->metrics_lock);
+	}
+	
+	if (metric && metric->type != type)
+		return NULL;
+	
+	return metric;
+}
+
+struct prometheus_metric *prometheus_exporter_register(struct prometheus_exporter *exporter,
+                                                       const char *name,
+                                                       const char *labels,
+                                                       enum metric_type type)
+{
+	return register_metric(exporter, name, labels, type, HDR_HISTOGRAM_DEFAULT_SCHEMA);
+}
+
+struct prometheus_metric *prometheus_exporter_register_histogram(struct prometheus_exporter *exporter,
+                                                                 const char *name,
+                                                                 const char *labels,
+                                                                 enum metric_type type,
+                                                                 int schema)
+{
+	if (type != METRIC_TYPE_HISTOGRAM && type != METRIC_TYPE_SUMMARY)
+		return NULL;
+	
+	if (schema < HDR_HISTOGRAM_MIN_SCHEMA || schema > HDR_HISTOGRAM_MAX_SCHEMA)
+		return NULL;
+	
+	return register_metric(exporter, name, labels, type, schema);
+}
+
+void prometheus_metric_inc(struct prometheus_metric *metric, uint64_t value)
+{
+	if (!metric || metric->type != METRIC_TYPE_COUNTER)
+		return;
+	
+	atomic_fetch_add_explicit(&metric->shards[current_shard()].count, value,
+	                          memory_order_relaxed);
+}
+
+void prometheus_metric_set(struct prometheus_metric *metric, double value)
+{
+	if (!metric || metric->type != METRIC_TYPE_GAUGE)
+		return;
+	
+	atomic_store_explicit(&metric->gauge, double_bits(value), memory_order_relaxed);
+}
+
+void prometheus_metric_observe(struct prometheus_metric *metric, double value)
+{
+	struct metric_shard *shard;
+	uint64_t old;
+	int i;
+	
+	if (!metric || !metric->hdr)
+		return;
+	
+	hdr_histogram_record(metric->hdr, value);
+	if (metric->type == METRIC_TYPE_SUMMARY)
+		return;
+	
+	shard = &metric->shards[current_shard()];
+	
+	/* Other threads share the shard rarely, the loop seldom repeats */
+	old = atomic_load_explicit(&shard->sum, memory_order_relaxed);
+	while (!atomic_compare_exchange_weak_explicit(&shard->sum, &old,
+	                                              double_bits(bits_double(old) + value),
+	                                              memory_order_relaxed,
+	                                              memory_order_relaxed))
+		;
+	
+	atomic_fetch_add_explicit(&shard->count, 1, memory_order_relaxed);
+	
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		if (value <= histogram_buckets[i])
+			atomic_fetch_add_explicit(&shard->buckets[i], 1, memory_order_relaxed);
+	}
+}
+
+static uint64_t sum_counts(const struct prometheus_metric *m)
+{
+	uint64_t total = 0;
+	int i;
+	
+	for (i = 0; i < PROM_SHARDS; i++)
+		total += atomic_load_explicit(&m->shards[i].count, memory_order_relaxed);
+	
+	return total;
+}
+
+/* Cumulative classic bucket counts of a histogram, summed over shards */
+static void sum_buckets(const struct prometheus_metric *m, uint64_t *buckets)
+{
+	int i, j;
+	
+	memset(buckets, 0, HISTOGRAM_BUCKETS * sizeof(*buckets));
+	for (i = 0; i < PROM_SHARDS; i++) {
+		for (j = 0; j < HISTOGRAM_BUCKETS; j++)
+			buckets[j] += atomic_load_explicit(&m->shards[i].buckets[j],
+			                                   memory_order_relaxed);
+	}
+}
+
+static double sum_values(const struct prometheus_metric *m)
+{
+	double sum = 0;
+	int i;
+	
+	for (i = 0; i < PROM_SHARDS; i++)
+		sum += bits_double(atomic_load_explicit(&m->shards[i].sum, memory_order_relaxed));
+	
+	return sum;
+}
+
+static void read_values(const struct prometheus_metric *m, struct metric_values *v)
+{
+	memset(v, 0, sizeof(*v));
+	v->hdr = m->hdr;
+	
+	switch (m->type) {
+	case METRIC_TYPE_COUNTER:
+		v->count = sum_counts(m);
+		break;
+	case METRIC_TYPE_GAUGE:
+		v->value = bits_double(atomic_load_explicit(&m->gauge, memory_order_relaxed));
+		break;
+	case METRIC_TYPE_HISTOGRAM:
+		v->count = sum_counts(m);
+		v->value = sum_values(m);
+		sum_buckets(m, v->buckets);
+		break;
+	case METRIC_TYPE_SUMMARY:
+		break;
+	}
+}
+
+/* What the governor compares series by, the observations of histograms */
+static uint64_t metric_progress(const struct prometheus_metric *m)
+{
+	switch (m->type) {
+	case METRIC_TYPE_COUNTER:
+	case METRIC_TYPE_HISTOGRAM:
+		return sum_counts(m);
+	case METRIC_TYPE_GAUGE:
+		return atomic_load_explicit(&m->gauge, memory_order_relaxed);
+	case METRIC_TYPE_SUMMARY:
+		return hdr_histogram_count(m->hdr);
+	}
+	return 0;
+}
+
+/* Values of an overflow series with the folded series of its name added */
+static void fold_values(struct prometheus_exporter *exporter,
+                        const struct prometheus_metric *overflow,
+                        const struct prometheus_metric *const *folded, unsigned int n,
+                        struct metric_values *v)
+{
+	struct metric_values fv;
+	unsigned int i;
+	int j;
+	
+	read_values(overflow, v);
+	
+	if (overflow->hdr) {
+		int schema = hdr_histogram_schema(overflow->hdr);
+		
+		if (exporter->fold_hdr && hdr_histogram_schema(exporter->fold_hdr) != schema) {
+			hdr_histogram_destroy(exporter->fold_hdr);
+			exporter->fold_hdr = NULL;
+		}
+		if (!exporter->fold_hdr)
+			exporter->fold_hdr = hdr_histogram_create(schema);
+		
+		/* Without scratch space the overflow series shows only its own */
+		if (exporter->fold_hdr) {
+			hdr_histogram_reset(exporter->fold_hdr);
+			hdr_histogram_merge(exporter->fold_hdr, overflow->hdr);
+			v->hdr = exporter->fold_hdr;
+		}
+	}
+	
+	for (i = 0; i < n; i++) {
+		if (folded[i]->type != overflow->type)
+			continue;
+		
+		read_values(folded[i], &fv);
+		v->count += fv.count;
+		v->value += fv.value;
+		for (j = 0; j < HISTOGRAM_BUCKETS; j++)
+			v->buckets[j] += fv.buckets[j];
+		if (v->hdr == exporter->fold_hdr && fv.hdr)
+			hdr_histogram_merge(exporter->fold_hdr, fv.hdr);
+	}
+}
+
+static void append_double(struct json_buf *buf, double value)
+{
+	char text[64];
+	int len;
+	
+	if (isnan(value)) {
+		json_buf_append_str(buf, "NaN");
+		return;
+	}
+	
+	if (isinf(value)) {
+		json_buf_append_str(buf, value > 0 ? "+Inf" : "-Inf");
+		return;
+	}
+	
+	len = snprintf(text, sizeof(text), "%.6f", value);
+	if (len > 0)
+		json_buf_append(buf, text, (size_t)len < sizeof(text) ? (size_t)len : sizeof(text) - 1);
+}
+
+/* Append name, its suffix and the label set with an optional extra label */
+static void append_series(struct json_buf *buf, const struct prometheus_metric *m,
+                          const char *suffix, const char *extra, const char *extra_value)
+{
+	json_buf_append_str(buf, m->name);
+	json_buf_append_str(buf, suffix);
+	
+	if (m->labels[0] || extra) {
+		json_buf_append_char(buf, '{');
+		json_buf_append_str(buf, m->labels);
+		if (extra) {
+			if (m->labels[0])
+				json_buf_append_char(buf, ',');
+			json_buf_append_str(buf, extra);
+			json_buf_append_str(buf, "=\"");
+			json_buf_append_str(buf, extra_value);
+			json_buf_append_char(buf, '"');
+		}
+		json_buf_append_char(buf, '}');
+	}
+	
+	json_buf_append_char(buf, ' ');
+}
+
+static void append_text_metric(struct json_buf *buf, const struct prometheus_metric *m,
+                               const struct metric_values *v)
+{
+	int j;
+	
+	switch (m->type) {
+	case METRIC_TYPE_COUNTER:
+		append_series(buf, m, "", NULL, NULL);
+		json_buf_append_u64(buf, v->count);
+		json_buf_append_char(buf, '\n');
+		break;
+		
+	case METRIC_TYPE_GAUGE:
+		append_series(buf, m, "", NULL, NULL);
+		append_double(buf, v->value);
+		json_buf_append_char(buf, '\n');
+		break;
+		
+	case METRIC_TYPE_HISTOGRAM:
+		for (j = 0; j < HISTOGRAM_BUCKETS; j++) {
+			append_series(buf, m, "_bucket", "le", bucket_labels[j]);
+			json_buf_append_u64(buf, v->buckets[j]);
+			json_buf_append_char(buf, '\n');
+		}
+		
+		append_series(buf, m, "_sum", NULL, NULL);
+		append_double(buf, v->value);
+		json_buf_append_char(buf, '\n');
+		append_series(buf, m, "_count", NULL, NULL);
+		json_buf_append_u64(buf, v->count);
+		json_buf_append_char(buf, '\n');
+		break;
+		
+	case METRIC_TYPE_SUMMARY:
+		for (j = 0; j < SUMMARY_QUANTILES; j++) {
+			append_series(buf, m, "", "quantile", quantile_labels[j]);
+			append_double(buf, hdr_histogram_quantile(v->hdr, summary_quantiles[j]));
+			json_buf_append_char(buf, '\n');
+		}
+		
+		append_series(buf, m, "_sum", NULL, NULL);
+		append_double(buf, hdr_histogram_sum(v->hdr));
+		json_buf_append_char(buf, '\n');
+		append_series(buf, m, "_count", NULL, NULL);
+		json_buf_append_u64(buf, hdr_histogram_count(v->hdr));
+		json_buf_append_char(buf, '\n');
+		break;
+	}
+}
+
+static const char *const type_help[] = {
+	[METRIC_TYPE_COUNTER] = "Counter metric",
+	[METRIC_TYPE_GAUGE] = "Gauge metric",
+	[METRIC_TYPE_HISTOGRAM] = "Histogram metric",
+	[METRIC_TYPE_SUMMARY] = "Summary metric",
+};
+
+static const char *const type_names[] = {
+	[METRIC_TYPE_COUNTER] = "counter",
+	[METRIC_TYPE_GAUGE] = "gauge",
+	[METRIC_TYPE_HISTOGRAM] = "histogram",
+	[METRIC_TYPE_SUMMARY] = "summary",
+};
+
+/* MetricType values of the protobuf format */
+static const unsigned int pb_types[] = {
+	[METRIC_TYPE_COUNTER] = 0,
+	[METRIC_TYPE_GAUGE] = 1,
+	[METRIC_TYPE_HISTOGRAM] = 4,
+	[METRIC_TYPE_SUMMARY] = 2,
+};
+
+static void append_text_family(struct json_buf *buf,
+                               const struct prometheus_metric *const *members,
+                               unsigned int n, const struct metric_values *overflow)
+{
+	const struct prometheus_metric *m = members[0];
+	struct metric_values v;
+	unsigned int i;
+	
+	json_buf_append_str(buf, "# HELP ");
+	json_buf_append_str(buf, m->name);
+	json_buf_append_char(buf, ' ');
+	json_buf_append_str(buf, type_help[m->type]);
+	json_buf_append_str(buf, "\n# TYPE ");
+	json_buf_append_str(buf, m->name);
+	json_buf_append_char(buf, ' ');
+	json_buf_append_str(buf, type_names[m->type]);
+	json_buf_append_char(buf, '\n');
+	
+	for (i = 0; i < n; i++) {
+		if (overflow && members[i]->overflow) {
+			append_text_metric(buf, members[i], overflow);
+		} else {
+			read_values(members[i], &v);
+			append_text_metric(buf, members[i], &v);
+		}
+	}
+}
+
+/* Protobuf wire types */
+#define PB_VARINT 0
+#define PB_FIXED64 1
+#define PB_BYTES 2
+
+static void pb_varint(struct json_buf *buf, uint64_t value)
+{
+	char bytes[10];
+	size_t len = 0;
+	
+	while (value >= 0x80) {
+		bytes[len++] = (char)(value | 0x80);
+		value >>= 7;
+	}
+	bytes[len++] = (char)value;
+	
+	json_buf_append(buf, bytes, len);
+}
+
+static inline void pb_key(struct json_buf *buf, unsigned int field, unsigned int wire)
+{
+	pb_varint(buf, (uint64_t)field << 3 | wire);
+}
+
+static void pb_uint(struct json_buf *buf, unsigned int field, uint64_t value)
+{
+	pb_key(buf, field, PB_VARINT);
+	pb_varint(buf, value);
+}
+
+/* sint32 and sint64 fields, zigzag encoded */
+static void pb_sint(struct json_buf *buf, unsigned int field, int64_t value)
+{
+	pb_key(buf, field, PB_VARINT);
+	pb_varint(buf, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static void pb_double(struct json_buf *buf, unsigned int field, double value)
+{
+	uint64_t bits = double_bits(value);
+	char bytes[8];
+	int i;
+	
+	for (i = 0; i < 8; i++)
+		bytes[i] = (char)(bits >> (8 * i));
+	
+	pb_key(buf, field, PB_FIXED64);
+	json_buf_append(buf, bytes, sizeof(bytes));
+}
+
+static void pb_bytes(struct json_buf *buf, unsigned int field, const char *data, size_t len)
+{
+	pb_key(buf, field, PB_BYTES);
+	pb_varint(buf, len);
+	json_buf_append(buf, data, len);
+}
+
+/* Append sub as an embedded message and empty it for the next one */
+static void pb_message(struct json_buf *buf, unsigned int field, struct json_buf *sub)
+{
+	pb_bytes(buf, field, sub->data, sub->len);
+	json_buf_reset(sub);
+}
+
+/* Append a LabelPair for each name="value" of a label string */
+static void pb_labels(struct json_buf *buf, struct json_buf *pair, const char *labels)
+{
+	char value[MAX_METRIC_LABELS];
+	
+	while (*labels) {
+		const char *name = labels;
+		const char *eq = strchr(labels, '=');
+		size_t len = 0;
+		
+		if (!eq || eq[1] != '"')
+			return;
+		
+		labels = eq + 2;
+		while (*labels && *labels != '"') {
+			char c = *labels++;
+			
+			if (c == '\\' && *labels) {
+				c = *labels++;
+				if (c == 'n')
+					c = '\n';
+			}
+			value[len++] = c;
+		}
+		
+		pb_bytes(pair, 1, name, (size_t)(eq - name));
+		pb_bytes(pair, 2, value, len);
+		pb_message(buf, 1, pair);
+		
+		if (*labels == '"')
+			labels++;
+		while (*labels == ',' || *labels == ' ')
+			labels++;
+	}
+}
+
+/* Native histogram spans and deltas of the non-empty HDR buckets */
+static void pb_native_buckets(struct json_buf *hist, struct json_buf *span,
+                              struct json_buf *deltas, const struct hdr_histogram *hdr)
+{
+	int key = HDR_HISTOGRAM_FIRST_KEY;
+	int next = 0, length = 0;
+	uint64_t count, prev = 0;
+	bool first = true;
+	
+	while (hdr_histogram_next_bucket(hdr, &key, &count)) {
+		if (length && key != next) {
+			pb_uint(span, 2, (uint64_t)length);
+			pb_message(hist, 12, span);
+			length = 0;
+		}
+		
+		/* First span offset is absolute, later ones skip the gap */
+		if (!length) {
+			pb_sint(span, 1, first ? key : key - next);
+			first = false;
+		}
+		
+		pb_sint(deltas, 13, (int64_t)(count - prev));
+		prev = count;
+		next = key + 1;
+		length++;
+	}
+	
+	if (length) {
+		pb_uint(span, 2, (uint64_t)length);
+		pb_message(hist, 12, span);
+	}
+	
+	json_buf_append(hist, deltas->data, deltas->len);
+	json_buf_reset(deltas);
+}
+
+static void pb_metric(struct prometheus_exporter *exporter, struct json_buf *metric,
+                      const struct prometheus_metric *m, const struct metric_values *v)
+{
+	struct json_buf *inner = &exporter->scratch[2];
+	struct json_buf *leaf = &exporter->scratch[3];
+	struct json_buf *deltas = &exporter->scratch[4];
+	int j;
+	
+	pb_labels(metric, leaf, m->labels);
+	
+	switch (m->type) {
+	case METRIC_TYPE_COUNTER:
+		pb_double(inner, 1, (double)v->count);
+		pb_message(metric, 3, inner);
+		break;
+		
+	case METRIC_TYPE_GAUGE:
+		pb_double(inner, 1, v->value);
+		pb_message(metric, 2, inner);
+		break;
+		
+	case METRIC_TYPE_HISTOGRAM:
+		pb_uint(inner, 1, hdr_histogram_count(v->hdr));
+		pb_double(inner, 2, hdr_histogram_sum(v->hdr));
+		
+		/* Classic buckets, +Inf is implied by the sample count */
+		for (j = 0; j < HISTOGRAM_BUCKETS - 1; j++) {
+			pb_uint(leaf, 1, v->buckets[j]);
+			pb_double(leaf, 2, histogram_buckets[j]);
+			pb_message(inner, 3, leaf);
+		}
+		
+		pb_sint(inner, 5, hdr_histogram_schema(v->hdr));
+		pb_double(inner, 6, HDR_HISTOGRAM_ZERO_THRESHOLD);
+		pb_uint(inner, 7, hdr_histogram_zero_count(v->hdr));
+		pb_native_buckets(inner, leaf, deltas, v->hdr);
+		pb_message(metric, 7, inner);
+		break;
+		
+	case METRIC_TYPE_SUMMARY:
+		pb_uint(inner, 1, hdr_histogram_count(v->hdr));
+		pb_double(inner, 2, hdr_histogram_sum(v->hdr));
+		for (j = 0; j < SUMMARY_QUANTILES; j++) {
+			pb_double(leaf, 1, summary_quantiles[j]);
+			pb_double(leaf, 2, hdr_histogram_quantile(v->hdr, summary_quantiles[j]));
+			pb_message(inner, 3, leaf);
+		}
+		pb_message(metric, 4, inner);
+		break;
+	}
+}
+
+/* Append one length delimited MetricFamily */
+static void append_proto_family(struct prometheus_exporter *exporter, struct json_buf *buf,
+                                const struct prometheus_metric *const *members,
+                                unsigned int n, const struct metric_values *overflow)
+{
+	struct json_buf *family = &exporter->scratch[0];
+	struct json_buf *metric = &exporter->scratch[1];
+	const struct prometheus_metric *m = members[0];
+	struct metric_values v;
+	unsigned int i;
+	
+	for (i = 0; i < PB_DEPTH; i++)
+		json_buf_reset(&exporter->scratch[i]);
+	
+	pb_bytes(family, 1, m->name, strlen(m->name));
+	pb_bytes(family, 2, type_help[m->type], strlen(type_help[m->type]));
+	pb_uint(family, 3, pb_types[m->type]);
+	
+	for (i = 0; i < n; i++) {
+		if (overflow && members[i]->overflow) {
+			pb_metric(exporter, metric, members[i], overflow);
+		} else {
+			read_values(members[i], &v);
+			pb_metric(exporter, metric, members[i], &v);
+		}
+		pb_message(family, 4, metric);
+	}
+	
+	/* A scratch allocation failure fails the whole response */
+	for (i = 0; i < PB_DEPTH; i++)
+		buf->failed |= exporter->scratch[i].failed;
+	
+	pb_varint(buf, family->len);
+	json_buf_append(buf, family->data, family->len);
+	json_buf_reset(family);
+}
+
+static void publish_cardinality(const struct cardinality_stats *stats, void *ctx)
+{
+	struct prometheus_exporter *exporter = ctx;
+	char labels[MAX_METRIC_LABELS];
+	
+	snprintf(labels, sizeof(labels), "metric=\"%s\"", stats->name);
+	prometheus_exporter_set_gauge(exporter, GOVERNANCE_PREFIX, labels,
+	                              (double)stats->series);
+	prometheus_exporter_set_gauge(exporter, GOVERNANCE_PREFIX "_collapsed", labels,
+	                              (double)stats->rejected);
+	prometheus_exporter_set_gauge(exporter, GOVERNANCE_PREFIX "_folded", labels,
+	                              (double)stats->folded);
+	prometheus_exporter_set_gauge(exporter, GOVERNANCE_PREFIX "_expired", labels,
+	                              (double)stats->expired);
+}
+
+/* Decide per series whether the next response shows, folds or leaves it out */
+static void govern_metrics(struct prometheus_exporter *exporter)
+{
+	struct cardinality_series *series[MAX_METRICS];
+	bool done[MAX_METRICS] = { false };
+	uint64_t now = monotonic_ms();
+	unsigned int count, i, j, n;
+	bool has_overflow;
+	int schema;
+	
+	count = atomic_load_explicit(&exporter->metric_count, memory_order_acquire);
+	
+	for (i = 0; i < count; i++) {
+		struct prometheus_metric *m = exporter->metrics[i];
+		
+		if (done[i] || is_governance(m->name))
+			continue;
+		
+		n = 0;
+		has_overflow = false;
+		for (j = i; j < count; j++) {
+			struct prometheus_metric *other = exporter->metrics[j];
+			
+			if (done[j] || other->name_hash != m->name_hash ||
+			    strcmp(other->name, m->name) != 0)
+				continue;
+			
+			done[j] = true;
+			if (other->overflow) {
+				has_overflow = true;
+				continue;
+			}
+			
+			cardinality_series_update(&other->activity, metric_progress(other),
+			                          other->type != METRIC_TYPE_GAUGE, now);
+			series[n++] = &other->activity;
+		}
+		
+		/* Folding needs a series to fold into, shown from the next response */
+		if (cardinality_governor_select(exporter->governor, m->name, series, n, now) &&
+		    !has_overflow) {
+			schema = m->hdr ? hdr_histogram_schema(m->hdr) : HDR_HISTOGRAM_DEFAULT_SCHEMA;
+			pthread_mutex_lock(&exporter->metrics_lock);
+			overflow_metric(exporter, m->name, m->name_hash, m->type, schema);
+			pthread_mutex_unlock(&exporter->metrics_lock);
+		}
+	}
+	
+	cardinality_governor_for_each(exporter->governor, publish_cardinality, exporter);
+}
+
+static void generate_metrics_response(struct prometheus_exporter *exporter,
+                                      struct json_buf *buf,
+                                      enum scrape_format format)
+{
+	const struct prometheus_metric *members[MAX_METRICS];
+	const struct prometheus_metric *folded[MAX_METRICS];
+	bool done[MAX_METRICS] = { false };
+	bool governed = cardinality_governor_active(exporter->governor);
+	const struct prometheus_metric *overflow;
+	struct metric_values overflow_values;
+	unsigned int count, i, j, n, nfolded;
+	
+	if (governed)
+		govern_metrics(exporter);
+	
+	json_buf_reset(buf);
+	count = atomic_load_explicit(&exporter->metric_count, memory_order_acquire);
+	
+	/* One family per name, holding every label set of it */
+	for (i = 0; i < count; i++) {
+		const struct prometheus_metric *m = exporter->metrics[i];
+		
+		if (done[i])
+			continue;
+		
+		n = nfolded = 0;
+		overflow = NULL;
+		for (j = i; j < count; j++) {
+			const struct prometheus_metric *other = exporter->metrics[j];
+			
+			if (done[j] || other->name_hash != m->name_hash ||
+			    strcmp(other->name, m->name) != 0)
+				continue;
+			
+			done[j] = true;
+			if (other->overflow)
+				overflow = other;
+			
+			if (!governed || other->activity.verdict == CARDINALITY_SHOW)
+				members[n++] = other;
+			else if (other->activity.verdict == CARDINALITY_FOLD)
+				folded[nfolded++] = other;
+		}
+		
+		/* Every series of the name went stale */
+		if (!n)
+			continue;
+		
+		if (overflow && nfolded)
+			fold_values(exporter, overflow, folded, nfolded, &overflow_values);
+		else
+			overflow = NULL;
+		
+		if (format == SCRAPE_PROTOBUF)
+			append_proto_family(exporter, buf, members, n,
+			                    overflow ? &overflow_values : NULL);
+		else
+			append_text_family(buf, members, n, overflow ? &overflow_values : NULL);
+	}
+}
+
+static struct scrape_body *body_create(const char *data, size_t len)
+{
+	struct scrape_body *body = malloc(sizeof(*body) + len);
+	
+	if (!body)
+		return NULL;
+	
+	body->refs = 1;
+	body->len = len;
+	memcpy(body->data, data, len);
+	return body;
+}
+
+static inline struct scrape_body *body_get(struct scrape_body *body)
+{
+	if (body)
+		body->refs++;
+	return body;
+}
 
-struct metric {
-	char name[MAX_METRIC_NAME];
-	char labels[MAX_METRIC_LABELS];
-	enum metric_type type;
-	union {
-		uint64_t counter;
-		double gauge;
-		struct {
-			double sum;
-			uint64_t count;
-			uint64_t buckets[10];  /* Predefined buckets */
-		} histogram;
-	} value;
-	bool in_use;
-};
+static void body_put(struct scrape_body *body)
+{
+	if (body && --body->refs == 0)
+		free(body);
+}
 
-struct prometheus_exporter {
-	int listen_sock;
-	uint16_t port;
-	char *path;
-	pthread_t thread;
-	bool running;
+/* Compress a body into one gzip member, NULL if zlib fails */
+static struct scrape_body *body_gzip(const struct scrape_body *plain)
+{
+	struct scrape_body *body;
+	z_stream zs;
+	uLong bound;
+	
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return NULL;
 	
-	/* Metrics storage */
-	struct metric metrics[MAX_METRICS];
-	pthread_mutex_t metrics_lock;
+	bound = deflateBound(&zs, plain->len);
+	body = malloc(sizeof(*body) + bound);
+	if (!body) {
+		deflateEnd(&zs);
+		return NULL;
+	}
 	
-	/* Statistics */
-	uint64_t requests_served;
-	uint64_t last_scrape_time;
+	zs.next_in = (Bytef *)plain->data;
+	zs.avail_in = (uInt)plain->len;
+	zs.next_out = (Bytef *)body->data;
+	zs.avail_out = (uInt)bound;
 	
-	/* System metrics */
-	double cpu_usage;
-	uint64_t memory_rss;
-	uint64_t memory_vms;
-};
+	if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+		deflateEnd(&zs);
+		free(body);
+		return NULL;
+	}
+	
+	body->refs = 1;
+	body->len = zs.total_out;
+	deflateEnd(&zs);
+	return body;
+}
 
-static const double histogram_buckets[] = {
-	0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1.0, 5.0, 10.0, +INFINITY
-};
+/* Regenerate a cached response once it is older than the interval */
+static struct scrape_response *refresh_response(struct prometheus_exporter *exporter,
+                                                enum scrape_format format)
+{
+	struct scrape_response *response = &exporter->responses[format];
+	unsigned int interval = atomic_load_explicit(&exporter->cache_interval_ms,
+	                                             memory_order_relaxed);
+	uint64_t now = monotonic_ms();
+	struct scrape_body *plain;
+	
+	if (response->plain && interval && now - response->time_ms < interval)
+		return response;
+	
+	generate_metrics_response(exporter, &exporter->build, format);
+	if (exporter->build.failed) {
+		json_buf_reset(&exporter->build);
+		return response->plain ? response : NULL;
+	}
+	
+	plain = body_create(exporter->build.data, exporter->build.len);
+	if (!plain)
+		return response->plain ? response : NULL;
+	
+	/* Connections still sending the old bodies hold their own references */
+	body_put(response->plain);
+	body_put(response->gzip);
+	response->plain = plain;
+	response->gzip = NULL;
+	response->time_ms = now;
+	return response;
+}
 
-static struct metric *find_or_create_metric(struct prometheus_exporter *exporter,
-                                           const char *name,
-                                           const char *labels,
-                                           enum metric_type type)
+/* Whether header name of the request contains token, case insensitively */
+static bool header_has(const char *headers, const char *name, const char *token)
 {
-	struct metric *metric = NULL;
-	int i;
+	size_t name_len = strlen(name);
+	const char *line = headers;
 	
-	/* Find existing metric */
-	for (i = 0; i < MAX_METRICS; i++) {
-		if (exporter->metrics[i].in_use &&
-		    strcmp(exporter->metrics[i].name, name) == 0 &&
-		    strcmp(exporter->metrics[i].labels, labels ? labels : "") == 0) {
-			return &exporter->metrics[i];
-		}
-	}
-	
-	/* Create new metric */
-	for (i = 0; i < MAX_METRICS; i++) {
-		if (!exporter->metrics[i].in_use) {
-			metric = &exporter->metrics[i];
-			strncpy(metric->name, name, MAX_METRIC_NAME - 1);
-			metric->name[MAX_METRIC_NAME - 1] = '\0';
-			strncpy(metric->labels, labels ? labels : "", MAX_METRIC_LABELS - 1);
-			metric->labels[MAX_METRIC_LABELS - 1] = '\0';
-			metric->type = type;
-			memset(&metric->value, 0, sizeof(metric->value));
-			metric->in_use = true;
-			return metric;
-		}
+	while ((line = strstr(line, "\r\n")) != NULL) {
+		const char *end;
+		char value[512];
+		size_t len;
+		
+		line += 2;
+		if (strncasecmp(line, name, name_len) != 0 || line[name_len] != ':')
+			continue;
+		
+		end = strstr(line, "\r\n");
+		len = end ? (size_t)(end - line) : strlen(line);
+		len -= name_len + 1;
+		if (len >= sizeof(value))
+			len = sizeof(value) - 1;
+		memcpy(value, line + name_len + 1, len);
+		value[len] = '\0';
+		
+		if (strcasestr(value, token))
+			return true;
 	}
 	
-	return NULL;
+	return false;
 }
 
-static void generate_metrics_response(struct prometheus_exporter *exporter,
-                                     char *buffer, size_t buffer_size)
+static void conn_respond(struct http_conn *conn, const char *status,
+                         const char *content_type, const char *encoding,
+                         struct scrape_body *body)
 {
-	size_t offset = 0;
-	int i, j;
+	int len;
+	
+	len = snprintf(conn->header, sizeof(conn->header),
+	               "HTTP/1.1 %s\r\n"
+	               "%s%s%s"
+	               "%s%s%s"
+	               "Content-Length: %zu\r\n"
+	               "Connection: %s\r\n"
+	               "\r\n",
+	               status,
+	               content_type ? "Content-Type: " : "", content_type ? content_type : "",
+	               content_type ? "\r\n" : "",
+	               encoding ? "Content-Encoding: " : "", encoding ? encoding : "",
+	               encoding ? "\r\n" : "",
+	               body ? body->len : 0,
+	               conn->keep_alive ? "keep-alive" : "close");
+	
+	conn->header_len = (size_t)len < sizeof(conn->header) ? (size_t)len : sizeof(conn->header) - 1;
+	conn->body = body;
+	conn->sent = 0;
+	conn->sending = true;
+}
+
+/*
+ * Parse the request at the start of the connection's buffer and queue
+ * its response. Returns 1 if a response is queued, 0 if the request is
+ * incomplete, -1 if the connection should be closed.
+ */
+static int conn_parse(struct prometheus_exporter *exporter, struct http_conn *conn)
+{
+	struct scrape_response *response;
+	struct scrape_body *body;
+	enum scrape_format format;
+	char *end, *path, *path_end, *version;
+	size_t request_len, path_len;
+	
+	end = memmem(conn->request, conn->request_len, "\r\n\r\n", 4);
+	if (!end)
+		return conn->request_len == sizeof(conn->request) ? -1 : 0;
 	
-	pthread_mutex_lock(&exporter->metrics_lock);
+	/* Terminate the header block, later pipelined requests stay intact */
+	request_len = (size_t)(end - conn->request) + 4;
+	end[2] = '\0';
 	
-	/* Generate metrics in Prometheus text format */
-	for (i = 0; i < MAX_METRICS && offset < buffer_size - 1024; i++) {
-		struct metric *m = &exporter->metrics[i];
+	path = strchr(conn->request, ' ');
+	path_end = path ? strchr(path + 1, ' ') : NULL;
+	if (!path_end || path_end > end)
+		return -1;
+	
+	path++;
+	path_len = (size_t)(path_end - path);
+	version = path_end + 1;
+	
+	if (strncmp(version, "HTTP/1.0", 8) == 0)
+		conn->keep_alive = header_has(conn->request, "Connection", "keep-alive");
+	else
+		conn->keep_alive = !header_has(conn->request, "Connection", "close");
+	
+	conn->metrics = false;
+	if (strncmp(conn->request, "GET ", 4) != 0) {
+		conn_respond(conn, "405 Method Not Allowed", NULL, NULL, NULL);
+	} else if (path_len != strlen(exporter->path) ||
+	           strncmp(path, exporter->path, path_len) != 0) {
+		conn_respond(conn, "404 Not Found", NULL, NULL, NULL);
+	} else {
+		/* Prometheus asks for protobuf to get native histograms */
+		format = header_has(conn->request, "Accept", "application/vnd.google.protobuf") ?
+		         SCRAPE_PROTOBUF : SCRAPE_TEXT;
+		response = refresh_response(exporter, format);
 		
-		if (!m->in_use)
-			continue;
+		if (!response) {
+			conn->keep_alive = false;
+			conn_respond(conn, "503 Service Unavailable", NULL, NULL, NULL);
+		} else if (header_has(conn->request, "Accept-Encoding", "gzip") &&
+		           (response->gzip ||
+		            (response->gzip = body_gzip(response->plain)) != NULL)) {
+			body = body_get(response->gzip);
+			conn_respond(conn, "200 OK", content_types[format], "gzip", body);
+			conn->metrics = true;
+		} else {
+			body = body_get(response->plain);
+			conn_respond(conn, "200 OK", content_types[format], NULL, body);
+			conn->metrics = true;
+		}
+	}
+	
+	conn->request_len -= request_len;
+	memmove(conn->request, conn->request + request_len, conn->request_len);
+	return 1;
+}
+
+/* Write what the socket takes, returns false on error */
+static bool conn_flush(struct http_conn *conn)
+{
+	size_t body_len = conn->body ? conn->body->len : 0;
+	size_t total = conn->header_len + body_len;
+	
+	while (conn->sent < total) {
+		struct iovec iov[2];
+		int iovcnt = 0;
+		ssize_t n;
 		
-		switch (m->type) {
-		case METRIC_TYPE_COUNTER:
-			offset += snprintf(buffer + offset, buffer_size - offset,
-			                  "# HELP %s Counter metric\n", m->name);
-			offset += snprintf(buffer + offset, buffer_size - offset,
-			                  "# TYPE %s counter\n", m->name);
-			if (m->labels[0]) {
-				offset += snprintf(buffer + offset, buffer_size - offset,
-				                  "%s{%s} %lu\n", m->name, m->labels,
-				                  m->value.counter);
-			} else {
-				offset += snprintf(buffer + offset, buffer_size - offset,
-				                  "%s %lu\n", m->name, m->value.counter);
-			}
-			break;
-			
-		case METRIC_TYPE_GAUGE:
-			offset += snprintf(buffer + offset, buffer_size - offset,
-			                  "# HELP %s Gauge metric\n", m->name);
-			offset += snprintf(buffer + offset, buffer_size - offset,
-			                  "# TYPE %s gauge\n", m->name);
-			if (m->labels[0]) {
-				offset += snprintf(buffer + offset, buffer_size - offset,
-				                  "%s{%s} %.6f\n", m->name, m->labels,
-				                  m->value.gauge);
-			} else {
-				offset += snprintf(buffer + offset, buffer_size - offset,
-				                  "%s %.6f\n", m->name, m->value.gauge);
-			}
-			break;
-			
-		case METRIC_TYPE_HISTOGRAM:
-			offset += snprintf(buffer + offset, buffer_size - offset,
-			                  "# HELP %s Histogram metric\n", m->name);
-			offset += snprintf(buffer + offset, buffer_size - offset,
-			                  "# TYPE %s histogram\n", m->name);
+		if (conn->sent < conn->header_len) {
+			iov[iovcnt].iov_base = conn->header + conn->sent;
+			iov[iovcnt].iov_len = conn->header_len - conn->sent;
+			iovcnt++;
+		}
+		if (body_len) {
+			size_t off = conn->sent > conn->header_len ? conn->sent - conn->header_len : 0;
 			
-			/* Buckets */
-			for (j = 0; j < 10; j++) {
-				char le_str[32];
-				if (j == 9) {
-					snprintf(le_str, sizeof(le_str), "+Inf");
-				} else {
-					snprintf(le_str, sizeof(le_str), "%.3f", histogram_buckets[j]);
-				}
-				
-				if (m->labels[0]) {
-					offset += snprintf(buffer + offset, buffer_size - offset,
-					                  "%s_bucket{%s,le=\"%s\"} %lu\n",
-					                  m->name, m->labels, le_str,
-					                  m->value.histogram.buckets[j]);
-				} else {
-					offset += snprintf(buffer + offset, buffer_size - offset,
-					                  "%s_bucket{le=\"%s\"} %lu\n",
-					                  m->name, le_str,
-					                  m->value.histogram.buckets[j]);
-				}
-			}
+			iov[iovcnt].iov_base = conn->body->data + off;
+			iov[iovcnt].iov_len = body_len - off;
+			iovcnt++;
+		}
+		
+		n = writev(conn->fd, iov, iovcnt);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		
+		conn->sent += (size_t)n;
+		conn->active_ms = monotonic_ms();
+	}
+	
+	conn->sending = false;
+	return true;
+}
+
+static bool conn_watch(struct prometheus_exporter *exporter, struct http_conn *conn,
+                       uint32_t events)
+{
+	struct epoll_event ev = { .events = events | EPOLLRDHUP, .data.ptr = conn };
+	
+	if (conn->events == events)
+		return true;
+	
+	conn->events = events;
+	return epoll_ctl(exporter->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) == 0;
+}
+
+/* Send queued responses and parse buffered requests, false to close */
+static bool conn_run(struct prometheus_exporter *exporter, struct http_conn *conn)
+{
+	for (;;) {
+		if (conn->sending) {
+			if (!conn_flush(conn))
+				return false;
+			if (conn->sending)
+				return conn_watch(exporter, conn, EPOLLOUT);
 			
-			/* Sum and count */
-			if (m->labels[0]) {
-				offset += snprintf(buffer + offset, buffer_size - offset,
-				                  "%s_sum{%s} %.6f\n", m->name, m->labels,
-				                  m->value.histogram.sum);
-				offset += snprintf(buffer + offset, buffer_size - offset,
-				                  "%s_count{%s} %lu\n", m->name, m->labels,
-				                  m->value.histogram.count);
-			} else {
-				offset += snprintf(buffer + offset, buffer_size - offset,
-				                  "%s_sum %.6f\n", m->name,
-				                  m->value.histogram.sum);
-				offset += snprintf(buffer + offset, buffer_size - offset,
-				                  "%s_count %lu\n", m->name,
-				                  m->value.histogram.count);
+			body_put(conn->body);
+			conn->body = NULL;
+			if (conn->metrics) {
+				atomic_fetch_add_explicit(&exporter->requests_served, 1,
+				                          memory_order_relaxed);
+				atomic_store_explicit(&exporter->last_scrape_time, time(NULL),
+				                      memory_order_relaxed);
 			}
-			break;
+			if (!conn->keep_alive)
+				return false;
+		}
+		
+		switch (conn_parse(exporter, conn)) {
+		case 0:
+			return conn_watch(exporter, conn, EPOLLIN);
+		case -1:
+			return false;
 		}
 	}
-	
-	pthread_mutex_unlock(&exporter->metrics_lock);
 }
 
-static void handle_http_request(struct prometheus_exporter *exporter, int client_sock)
+/* Read what has arrived, false if the peer closed or failed */
+static bool conn_read(struct http_conn *conn)
 {
-	char request[4096];
-	char response[RESPONSE_BUFFER_SIZE];
-	char *metrics_buffer;
-	ssize_t n;
-	
-	/* Read request */
-	n = recv(client_sock, request, sizeof(request) - 1, 0);
-	if (n <= 0) {
-		close(client_sock);
-		return;
+	while (conn->request_len < sizeof(conn->request)) {
+		ssize_t n = recv(conn->fd, conn->request + conn->request_len,
+		                 sizeof(conn->request) - conn->request_len, 0);
+		
+		if (n > 0) {
+			conn->request_len += (size_t)n;
+			conn->active_ms = monotonic_ms();
+			continue;
+		}
+		if (n == 0)
+			return false;
+		if (errno == EINTR)
+			continue;
+		return errno == EAGAIN || errno == EWOULDBLOCK;
 	}
-	request[n] = '\0';
-	
-	/* Check if it's a GET request for our metrics path */
-	if (strncmp(request, "GET ", 4) == 0) {
-		char *path_start = request + 4;
-		char *path_end = strchr(path_start, ' ');
-		
-		if (path_end) {
-			size_t path_len = path_end - path_start;
-			if (path_len == strlen(exporter->path) &&
-			    strncmp(path_start, exporter->path, path_len) == 0) {
-				/* Generate metrics */
-				metrics_buffer = malloc(RESPONSE_BUFFER_SIZE);
-				if (metrics_buffer) {
-					generate_metrics_response(exporter, metrics_buffer,
-					                         RESPONSE_BUFFER_SIZE);
-					
-					/* Send HTTP response */
-					snprintf(response, sizeof(response),
-					        "HTTP/1.1 200 OK\r\n"
-					        "Content-Type: text/plain; version=0.0.4\r\n"
-					        "Content-Length: %zu\r\n"
-					        "Connection: close\r\n"
-					        "\r\n%s",
-					        strlen(metrics_buffer), metrics_buffer);
-					
-					send(client_sock, response, strlen(response), 0);
-					free(metrics_buffer);
-					
-					exporter->requests_served++;
-					exporter->last_scrape_time = time(NULL);
-				}
-			} else {
-				/* 404 Not Found */
-				snprintf(response, sizeof(response),
-				        "HTTP/1.1 404 Not Found\r\n"
-				        "Content-Length: 0\r\n"
-				        "Connection: close\r\n\r\n");
-				send(client_sock, response, strlen(response), 0);
-			}
+	
+	return true;
+}
+
+static void conn_close(struct prometheus_exporter *exporter, struct http_conn *conn)
+{
+	epoll_ctl(exporter->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+	body_put(conn->body);
+	exporter->conns[conn->slot] = NULL;
+	exporter->conn_count--;
+	free(conn);
+}
+
+static void accept_connections(struct prometheus_exporter *exporter)
+{
+	for (;;) {
+		struct epoll_event ev;
+		struct http_conn *conn;
+		unsigned int slot;
+		int fd;
+		
+		fd = accept4(exporter->listen_sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		
+		if (exporter->conn_count == MAX_CONNECTIONS) {
+			close(fd);
+			continue;
+		}
+		
+		conn = calloc(1, sizeof(*conn));
+		if (!conn) {
+			close(fd);
+			continue;
+		}
+		
+		for (slot = 0; exporter->conns[slot]; slot++)
+			;
+		
+		conn->fd = fd;
+		conn->slot = slot;
+		conn->events = EPOLLIN;
+		conn->active_ms = monotonic_ms();
+		
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.ptr = conn;
+		if (epoll_ctl(exporter->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			close(fd);
+			free(conn);
+			continue;
 		}
+		
+		exporter->conns[slot] = conn;
+		exporter->conn_count++;
 	}
+}
+
+/* Close connections that made no progress for IDLE_TIMEOUT_MS */
+static void close_idle(struct prometheus_exporter *exporter)
+{
+	uint64_t now = monotonic_ms();
+	unsigned int i;
 	
-	close(client_sock);
+	for (i = 0; i < MAX_CONNECTIONS; i++) {
+		struct http_conn *conn = exporter->conns[i];
+		
+		if (conn && now - conn->active_ms > IDLE_TIMEOUT_MS)
+			conn_close(exporter, conn);
+	}
 }
 
 static void *http_server_thread(void *arg)
 {
 	struct prometheus_exporter *exporter = arg;
-	struct sockaddr_in client_addr;
-	socklen_t client_len;
-	int client_sock;
-	
-	while (exporter->running) {
-		client_len = sizeof(client_addr);
-		client_sock = accept(exporter->listen_sock,
-		                    (struct sockaddr *)&client_addr,
-		                    &client_len);
-		
-		if (client_sock < 0) {
-			if (errno == EINTR || !exporter->running)
-				break;
-			continue;
+	struct epoll_event events[MAX_EVENTS];
+	uint64_t last_sweep = monotonic_ms();
+	
+	while (atomic_load(&exporter->running)) {
+		int n = epoll_wait(exporter->epoll_fd, events, MAX_EVENTS, 1000);
+		int i;
+		
+		if (n < 0 && errno != EINTR)
+			break;
+		
+		for (i = 0; i < n; i++) {
+			struct http_conn *conn = events[i].data.ptr;
+			
+			if (conn == LISTEN_TAG) {
+				accept_connections(exporter);
+				continue;
+			}
+			if (conn == WAKE_TAG)
+				continue;
+			
+			if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+				conn_close(exporter, conn);
+				continue;
+			}
+			
+			/* A peer that shut down writing may still wait for its response */
+			if ((events[i].events & EPOLLIN) && !conn_read(conn) && !conn->request_len) {
+				conn_close(exporter, conn);
+				continue;
+			}
+			
+			if (!conn_run(exporter, conn))
+				conn_close(exporter, conn);
 		}
 		
-		handle_http_request(exporter, client_sock);
+		if (monotonic_ms() - last_sweep >= 1000) {
+			close_idle(exporter);
+			last_sweep = monotonic_ms();
+		}
 	}
 	
 	return NULL;
@@ -279,7 +1541,9 @@ struct prometheus_exporter *prometheus_exporter_create(uint16_t port,
                                                        const char *path)
 {
 	struct prometheus_exporter *exporter;
+	struct epoll_event ev;
 	struct sockaddr_in addr;
+	socklen_t addr_len;
 	int opt = 1;
 	
 	if (!path)
@@ -289,22 +1553,25 @@ struct prometheus_exporter *prometheus_exporter_create(uint16_t port,
 	if (!exporter)
 		return NULL;
 	
+	exporter->listen_sock = -1;
+	exporter->epoll_fd = -1;
+	exporter->wake_fd = -1;
 	exporter->port = port;
 	exporter->path = strdup(path);
-	if (!exporter->path) {
-		free(exporter);
-		return NULL;
-	}
+	if (!exporter->path)
+		goto err_free;
+	
+	exporter->governor = cardinality_governor_create();
+	if (!exporter->governor)
+		goto err_path;
 	
 	pthread_mutex_init(&exporter->metrics_lock, NULL);
+	atomic_init(&exporter->cache_interval_ms, PROMETHEUS_CACHE_INTERVAL_MS);
 	
-	/* Create listening socket */
-	exporter->listen_sock = socket(AF_INET, SOCK_STREAM, 0);
-	if (exporter->listen_sock < 0) {
-		free(exporter->path);
-		free(exporter);
-		return NULL;
-	}
+	/* Create a non-blocking listening socket */
+	exporter->listen_sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (exporter->listen_sock < 0)
+		goto err_close;
 	
 	setsockopt(exporter->listen_sock, SOL_SOCKET, SO_REUSEADDR,
 	          &opt, sizeof(opt));
@@ -314,67 +1581,136 @@ struct prometheus_exporter *prometheus_exporter_create(uint16_t port,
 	addr.sin_addr.s_addr = INADDR_ANY;
 	addr.sin_port = htons(port);
 	
-	if (bind(exporter->listen_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-		close(exporter->listen_sock);
-		free(exporter->path);
-		free(exporter);
-		return NULL;
-	}
+	if (bind(exporter->listen_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		goto err_close;
 	
-	if (listen(exporter->listen_sock, 5) < 0) {
-		close(exporter->listen_sock);
-		free(exporter->path);
-		free(exporter);
-		return NULL;
-	}
+	/* Learn the port the kernel picked for port 0 */
+	addr_len = sizeof(addr);
+	if (getsockname(exporter->listen_sock, (struct sockaddr *)&addr, &addr_len) == 0)
+		exporter->port = ntohs(addr.sin_port);
+	
+	if (listen(exporter->listen_sock, LISTEN_BACKLOG) < 0)
+		goto err_close;
+	
+	exporter->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	exporter->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (exporter->epoll_fd < 0 || exporter->wake_fd < 0)
+		goto err_close;
+	
+	ev.events = EPOLLIN;
+	ev.data.ptr = LISTEN_TAG;
+	if (epoll_ctl(exporter->epoll_fd, EPOLL_CTL_ADD, exporter->listen_sock, &ev) < 0)
+		goto err_close;
+	
+	ev.data.ptr = WAKE_TAG;
+	if (epoll_ctl(exporter->epoll_fd, EPOLL_CTL_ADD, exporter->wake_fd, &ev) < 0)
+		goto err_close;
 	
 	/* Start HTTP server thread */
-	exporter->running = true;
-	if (pthread_create(&exporter->thread, NULL, http_server_thread, exporter) != 0) {
-		close(exporter->listen_sock);
-		free(exporter->path);
-		free(exporter);
-		return NULL;
-	}
+	atomic_init(&exporter->running, true);
+	if (pthread_create(&exporter->thread, NULL, http_server_thread, exporter) != 0)
+		goto err_close;
+	
+	thread_affinity_apply(exporter->thread, NULL, -1, "prom-http");
 	
 	return exporter;
+	
+err_close:
+	if (exporter->wake_fd >= 0)
+		close(exporter->wake_fd);
+	if (exporter->epoll_fd >= 0)
+		close(exporter->epoll_fd);
+	if (exporter->listen_sock >= 0)
+		close(exporter->listen_sock);
+	pthread_mutex_destroy(&exporter->metrics_lock);
+	cardinality_governor_destroy(exporter->governor);
+err_path:
+	free(exporter->path);
+err_free:
+	free(exporter);
+	return NULL;
+}
+
+bool prometheus_exporter_set_affinity(struct prometheus_exporter *exporter,
+                                      const char *cpus)
+{
+	if (!exporter || !thread_affinity_valid(cpus))
+		return false;
+	
+	thread_affinity_apply(exporter->thread, cpus, -1, NULL);
+	return true;
 }
 
 void prometheus_exporter_destroy(struct prometheus_exporter *exporter)
 {
+	unsigned int count, i;
+	
 	if (!exporter)
 		return;
 	
-	exporter->running = false;
+	atomic_store(&exporter->running, false);
+	if (eventfd_write(exporter->wake_fd, 1) == 0)
+		pthread_join(exporter->thread, NULL);
 	
-	if (exporter->listen_sock >= 0) {
-		shutdown(exporter->listen_sock, SHUT_RDWR);
-		close(exporter->listen_sock);
+	for (i = 0; i < MAX_CONNECTIONS; i++) {
+		if (exporter->conns[i])
+			conn_close(exporter, exporter->conns[i]);
 	}
 	
-	pthread_join(exporter->thread, NULL);
+	close(exporter->wake_fd);
+	close(exporter->epoll_fd);
+	close(exporter->listen_sock);
 	pthread_mutex_destroy(&exporter->metrics_lock);
 	
+	count = atomic_load_explicit(&exporter->metric_count, memory_order_relaxed);
+	for (i = 0; i < count; i++) {
+		hdr_histogram_destroy(exporter->metrics[i]->hdr);
+		free(exporter->metrics[i]);
+	}
+	
+	for (i = 0; i < SCRAPE_FORMATS; i++) {
+		body_put(exporter->responses[i].plain);
+		body_put(exporter->responses[i].gzip);
+	}
+	json_buf_free(&exporter->build);
+	for (i = 0; i < PB_DEPTH; i++)
+		json_buf_free(&exporter->scratch[i]);
+	hdr_histogram_destroy(exporter->fold_hdr);
+	cardinality_governor_destroy(exporter->governor);
 	free(exporter->path);
 	free(exporter);
 }
 
+uint16_t prometheus_exporter_get_port(struct prometheus_exporter *exporter)
+{
+	return exporter ? exporter->port : 0;
+}
+
+void prometheus_exporter_set_cache_interval(struct prometheus_exporter *exporter,
+                                            unsigned int interval_ms)
+{
+	if (exporter)
+		atomic_store_explicit(&exporter->cache_interval_ms, interval_ms,
+		                      memory_order_relaxed);
+}
+
+bool prometheus_exporter_set_cardinality(struct prometheus_exporter *exporter,
+                                         const char *name,
+                                         const struct cardinality_limits *limits)
+{
+	if (!exporter)
+		return false;
+	
+	return cardinality_governor_set_limits(exporter->governor, name, limits);
+}
+
 void prometheus_exporter_inc_counter(struct prometheus_exporter *exporter,
                                      const char *name,
                                      const char *labels,
                                      uint64_t value)
 {
-	struct metric *metric;
-	
-	if (!exporter || !name)
-		return;
-	
-	pthread_mutex_lock(&exporter->metrics_lock);
-	metric = find_or_create_metric(exporter, name, labels, METRIC_TYPE_COUNTER);
-	if (metric) {
-		metric->value.counter += value;
-	}
-	pthread_mutex_unlock(&exporter->metrics_lock);
+	prometheus_metric_inc(prometheus_exporter_register(exporter, name, labels,
+	                                                   METRIC_TYPE_COUNTER), value);
 }
 
 void prometheus_exporter_set_gauge(struct prometheus_exporter *exporter,
@@ -382,17 +1718,8 @@ void prometheus_exporter_set_gauge(struct prometheus_exporter *exporter,
                                    const char *labels,
                                    double value)
 {
-	struct metric *metric;
-	
-	if (!exporter || !name)
-		return;
-	
-	pthread_mutex_lock(&exporter->metrics_lock);
-	metric = find_or_create_metric(exporter, name, labels, METRIC_TYPE_GAUGE);
-	if (metric) {
-		metric->value.gauge = value;
-	}
-	pthread_mutex_unlock(&exporter->metrics_lock);
+	prometheus_metric_set(prometheus_exporter_register(exporter, name, labels,
+	                                                   METRIC_TYPE_GAUGE), value);
 }
 
 void prometheus_exporter_observe_histogram(struct prometheus_exporter *exporter,
@@ -400,26 +1727,17 @@ void prometheus_exporter_observe_histogram(struct prometheus_exporter *exporter,
                                           const char *labels,
                                           double value)
 {
-	struct metric *metric;
-	int i;
-	
-	if (!exporter || !name)
-		return;
-	
-	pthread_mutex_lock(&exporter->metrics_lock);
-	metric = find_or_create_metric(exporter, name, labels, METRIC_TYPE_HISTOGRAM);
-	if (metric) {
-		metric->value.histogram.sum += value;
-		metric->value.histogram.count++;
-		
-		/* Update buckets */
-		for (i = 0; i < 10; i++) {
-			if (value <= histogram_buckets[i]) {
-				metric->value.histogram.buckets[i]++;
-			}
-		}
-	}
-	pthread_mutex_unlock(&exporter->metrics_lock);
+	prometheus_metric_observe(prometheus_exporter_register(exporter, name, labels,
+	                                                       METRIC_TYPE_HISTOGRAM), value);
+}
+
+void prometheus_exporter_observe_summary(struct prometheus_exporter *exporter,
+                                         const char *name,
+                                         const char *labels,
+                                         double value)
+{
+	prometheus_metric_observe(prometheus_exporter_register(exporter, name, labels,
+	                                                       METRIC_TYPE_SUMMARY), value);
 }
 
 void prometheus_exporter_update_system_metrics(struct prometheus_exporter *exporter)
@@ -477,6 +1795,166 @@ void prometheus_exporter_update_system_metrics(struct prometheus_exporter *expor
 	}
 }
 
+void prometheus_exporter_publish_stats(const struct nlmon_stats_snapshot *snapshot, void *ctx)
+{
+	static const char *const targets[EXPORT_TARGET_COUNT] = {
+		[EXPORT_TARGET_PCAP] = "target=\"pcap\"",
+		[EXPORT_TARGET_JSON] = "target=\"json\"",
+		[EXPORT_TARGET_PROMETHEUS] = "target=\"prometheus\"",
+		[EXPORT_TARGET_SYSLOG] = "target=\"syslog\"",
+		[EXPORT_TARGET_LOG] = "target=\"log\"",
+		[EXPORT_TARGET_BINARY] = "target=\"binary\"",
+		[EXPORT_TARGET_BUS] = "target=\"bus\"",
+		[EXPORT_TARGET_STREAM] = "target=\"stream\"",
+		[EXPORT_TARGET_OTLP] = "target=\"otlp\"",
+	};
+	struct prometheus_exporter *exporter = ctx;
+	char labels[96];
+	size_t i;
+	
+	if (!exporter || !snapshot)
+		return;
+	
+	if (snapshot->have & STATS_HAVE_EVENTS) {
+		prometheus_exporter_set_gauge(exporter, "nlmon_pipeline_submitted", NULL,
+		                              snapshot->events.submitted);
+		prometheus_exporter_set_gauge(exporter, "nlmon_pipeline_processed", NULL,
+		                              snapshot->events.processed);
+		prometheus_exporter_set_gauge(exporter, "nlmon_pipeline_dropped", NULL,
+		                              snapshot->events.dropped);
+		prometheus_exporter_set_gauge(exporter, "nlmon_pipeline_rate_limited", NULL,
+		                              snapshot->events.rate_limited);
+		prometheus_exporter_set_gauge(exporter, "nlmon_pipeline_queue_size", NULL,
+		                              snapshot->events.queue_size);
+	}
+	
+	if (snapshot->have & STATS_HAVE_THREAD_POOL) {
+		prometheus_exporter_set_gauge(exporter, "nlmon_pipeline_pool_pending", NULL,
+		                              snapshot->thread_pool.pending);
+		prometheus_exporter_set_gauge(exporter, "nlmon_pipeline_pool_rejected", NULL,
+		                              snapshot->thread_pool.rejected);
+	}
+	
+	if (snapshot->have & STATS_HAVE_STORAGE) {
+		prometheus_exporter_set_gauge(exporter, "nlmon_storage_buffer_events", NULL,
+		                              snapshot->storage.buffer_size);
+		prometheus_exporter_set_gauge(exporter, "nlmon_storage_db_events", NULL,
+		                              snapshot->storage.db_event_count);
+		prometheus_exporter_set_gauge(exporter, "nlmon_storage_db_size_bytes", NULL,
+		                              snapshot->storage.db_size_bytes);
+	}
+	
+	for (i = 0; i < EXPORT_TARGET_COUNT; i++) {
+		const struct stats_export *queue = &snapshot->exports[i];
+		
+		if (!(snapshot->exports_enabled & (1u << i)))
+			continue;
+		prometheus_exporter_set_gauge(exporter, "nlmon_export_queue_depth", targets[i],
+		                              queue->queue_depth);
+		prometheus_exporter_set_gauge(exporter, "nlmon_export_dropped", targets[i],
+		                              queue->dropped);
+		prometheus_exporter_set_gauge(exporter, "nlmon_export_failed", targets[i],
+		                              queue->failed);
+		prometheus_exporter_set_gauge(exporter, "nlmon_export_sampled", targets[i],
+		                              queue->sampled);
+		prometheus_exporter_set_gauge(exporter, "nlmon_export_lag_seconds", targets[i],
+		                              queue->lag_us / 1e6);
+	}
+	
+	if (snapshot->have & STATS_HAVE_NETLINK) {
+		prometheus_exporter_set_gauge(exporter, "nlmon_netlink_messages_dropped", NULL,
+		                              snapshot->netlink.total_messages_dropped);
+		prometheus_exporter_set_gauge(exporter, "nlmon_netlink_socket_buffer_drops", NULL,
+		                              snapshot->netlink.socket_buffer_drops);
+		prometheus_exporter_set_gauge(exporter, "nlmon_netlink_memory_bytes", NULL,
+		                              snapshot->netlink.current_memory_bytes);
+	}
+	
+	for (i = 0; i < snapshot->num_plugins; i++) {
+		const struct stats_plugin *plugin = &snapshot->plugins[i];
+		
+		snprintf(labels, sizeof(labels), "plugin=\"%s\"", plugin->name);
+		prometheus_exporter_set_gauge(exporter, "nlmon_plugin_queue_depth", labels,
+		                              plugin->queue_depth);
+		prometheus_exporter_set_gauge(exporter, "nlmon_plugin_dropped", labels,
+		                              plugin->events_dropped);
+		prometheus_exporter_set_gauge(exporter, "nlmon_plugin_latency_p99_seconds", labels,
+		                              plugin->latency_p99_us / 1e6);
+	}
+	
+	for (i = 0; i < snapshot->num_batches; i++) {
+		const struct stats_batch *batch = &snapshot->batches[i];
+		
+		snprintf(labels, sizeof(labels), "stage=\"%s\"", batch->name);
+		prometheus_exporter_set_gauge(exporter, "nlmon_batch_size", labels, batch->size);
+		prometheus_exporter_set_gauge(exporter, "nlmon_batch_linger_seconds", labels,
+		                              batch->linger_us / 1e6);
+		prometheus_exporter_set_gauge(exporter, "nlmon_batch_latency_seconds", labels,
+		                              batch->latency_us / 1e6);
+		prometheus_exporter_set_gauge(exporter, "nlmon_batch_over_target", labels,
+		                              batch->over_target);
+	}
+	
+	if (snapshot->have & STATS_HAVE_HUGEPAGES) {
+		prometheus_exporter_set_gauge(exporter, "nlmon_hugepage_region_bytes", NULL,
+		                              snapshot->hugepages.bytes);
+		prometheus_exporter_set_gauge(exporter, "nlmon_hugepage_backed_bytes", NULL,
+		                              snapshot->hugepages.huge_bytes);
+	}
+}
+
+void prometheus_exporter_list_metrics(struct prometheus_exporter *exporter,
+                                      void (*fn)(const struct prometheus_sample *sample,
+                                                 void *ctx),
+                                      void *ctx)
+{
+	uint64_t buckets[HISTOGRAM_BUCKETS];
+	double values[SUMMARY_QUANTILES];
+	unsigned int count, i;
+	int j;
+	
+	if (!exporter || !fn)
+		return;
+	
+	count = atomic_load_explicit(&exporter->metric_count, memory_order_acquire);
+	for (i = 0; i < count; i++) {
+		const struct prometheus_metric *m = exporter->metrics[i];
+		struct prometheus_sample sample = {
+			.name = m->name,
+			.labels = m->labels,
+			.type = m->type,
+		};
+		
+		switch (m->type) {
+		case METRIC_TYPE_COUNTER:
+			sample.value = (double)sum_counts(m);
+			break;
+		case METRIC_TYPE_GAUGE:
+			sample.value = bits_double(atomic_load_explicit(&m->gauge, memory_order_relaxed));
+			break;
+		case METRIC_TYPE_HISTOGRAM:
+			sum_buckets(m, buckets);
+			sample.count = sum_counts(m);
+			sample.sum = sum_values(m);
+			sample.bounds = histogram_buckets;
+			sample.buckets = buckets;
+			sample.nbuckets = HISTOGRAM_BUCKETS;
+			break;
+		case METRIC_TYPE_SUMMARY:
+			for (j = 0; j < SUMMARY_QUANTILES; j++)
+				values[j] = hdr_histogram_quantile(m->hdr, summary_quantiles[j]);
+			sample.count = hdr_histogram_count(m->hdr);
+			sample.sum = hdr_histogram_sum(m->hdr);
+			sample.quantiles = summary_quantiles;
+			sample.quantile_values = values;
+			sample.nquantiles = SUMMARY_QUANTILES;
+			break;
+		}
+		
+		fn(&sample, ctx);
+	}
+}
+
 bool prometheus_exporter_get_stats(struct prometheus_exporter *exporter,
                                    uint64_t *requests_served,
                                    uint64_t *last_scrape_time)
@@ -485,9 +1963,11 @@ bool prometheus_exporter_get_stats(struct prometheus_exporter *exporter,
 		return false;
 	
 	if (requests_served)
-		*requests_served = exporter->requests_served;
+		*requests_served = atomic_load_explicit(&exporter->requests_served,
+		                                        memory_order_relaxed);
 	if (last_scrape_time)
-		*last_scrape_time = exporter->last_scrape_time;
+		*last_scrape_time = atomic_load_explicit(&exporter->last_scrape_time,
+		                                         memory_order_relaxed);
 	
 	return true;
 }
@@ -1,12 +1,25 @@
-/* syslog_forwarder.c - Syslog forwarding with RFC 5424 support */
+/* syslog_forwarder.c - Syslog forwarding with RFC 5424 support
+ *
+ * Messages are formatted into a pending buffer and sent in batches, UDP
+ * datagrams with one sendmmsg() and TCP or TLS streams as RFC 6587
+ * octet-counted frames with as few writes as the socket takes. While the
+ * connection is down the buffer keeps what it holds, so a reconnect
+ * sends the messages queued in the meantime.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 
 #include "syslog_forwarder.h"
+#include "adaptive_batch.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -20,12 +33,44 @@
 
 #define MAX_SYSLOG_MSG_SIZE 8192
 #define MAX_HOSTNAME_SIZE 256
+#define MAX_ORIGIN_SIZE 512
+
+/* Room for an RFC 6587 frame length "8192 " */
+#define FRAME_PREFIX_SIZE 5
+
+/* Smallest message, bounds how many fit in the pending buffer */
+#define MIN_MESSAGE_SIZE 32
+
+/* Datagrams per sendmmsg() call */
+#define UDP_BATCH 64
 
 struct syslog_forwarder {
 	struct syslog_config config;
 	int sock;
 	bool connected;
 	char hostname[MAX_HOSTNAME_SIZE];
+	time_t last_attempt;            /* Last connection attempt */
+	
+	/* "HOSTNAME APP-NAME PROCID " of every message */
+	char origin[MAX_ORIGIN_SIZE];
+	
+	/* Timestamp up to the fraction, rebuilt when the second changes */
+	time_t stamp_sec;
+	char stamp[80];
+	
+	/* Framed messages waiting to be sent, oldest first */
+	char *pending;
+	size_t pending_size;
+	size_t pending_len;
+	uint32_t *lengths;              /* Framed length of each message */
+	unsigned int count;
+	unsigned int max_count;
+	uint64_t first_ns;              /* When the oldest pending message was queued */
+	struct adaptive_batch *batcher; /* Messages per batch, up to batch_size */
+	
+	/* sendmmsg() vectors */
+	struct mmsghdr msgs[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
 	
 #ifdef ENABLE_TLS
 	SSL_CTX *ssl_ctx;
@@ -49,18 +94,24 @@ static bool get_hostname(char *hostname, size_t size)
 	return true;
 }
 
-static void format_rfc5424_timestamp(char *buffer, size_t size)
+/* Current time in microseconds, the cached timestamp is brought up to date */
+static long update_timestamp(struct syslog_forwarder *forwarder)
 {
 	struct timespec ts;
 	struct tm tm;
 	
 	clock_gettime(CLOCK_REALTIME, &ts);
-	gmtime_r(&ts.tv_sec, &tm);
 	
-	snprintf(buffer, size, "%04d-%02d-%02dT%02d:%02d:%02d.%06ldZ",
-	        tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
-	        tm.tm_hour, tm.tm_min, tm.tm_sec,
-	        ts.tv_nsec / 1000);
+	if (ts.tv_sec != forwarder->stamp_sec) {
+		gmtime_r(&ts.tv_sec, &tm);
+		snprintf(forwarder->stamp, sizeof(forwarder->stamp),
+		         "%04d-%02d-%02dT%02d:%02d:%02d.",
+		         tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+		         tm.tm_hour, tm.tm_min, tm.tm_sec);
+		forwarder->stamp_sec = ts.tv_sec;
+	}
+	
+	return ts.tv_nsec / 1000;
 }
 
 static bool connect_tcp(struct syslog_forwarder *forwarder)
@@ -205,8 +256,222 @@ static bool connect_tls(struct syslog_forwarder *forwarder)
 }
 #endif
 
+static void close_connection(struct syslog_forwarder *forwarder)
+{
+#ifdef ENABLE_TLS
+	if (forwarder->ssl) {
+		SSL_shutdown(forwarder->ssl);
+		SSL_free(forwarder->ssl);
+		forwarder->ssl = NULL;
+	}
+	if (forwarder->ssl_ctx) {
+		SSL_CTX_free(forwarder->ssl_ctx);
+		forwarder->ssl_ctx = NULL;
+	}
+#endif
+	
+	if (forwarder->sock >= 0) {
+		close(forwarder->sock);
+		forwarder->sock = -1;
+	}
+	
+	forwarder->connected = false;
+}
+
+static bool reconnect_locked(struct syslog_forwarder *forwarder)
+{
+	bool success = false;
+	
+	/* Close existing connection */
+	close_connection(forwarder);
+	forwarder->last_attempt = time(NULL);
+	
+	/* Attempt reconnection */
+	switch (forwarder->config.transport) {
+	case SYSLOG_TRANSPORT_UDP:
+		success = connect_udp(forwarder);
+		break;
+		
+	case SYSLOG_TRANSPORT_TCP:
+		success = connect_tcp(forwarder);
+		break;
+		
+	case SYSLOG_TRANSPORT_TLS:
+#ifdef ENABLE_TLS
+		success = connect_tls(forwarder);
+#else
+		/* TLS not supported in this build */
+		success = false;
+#endif
+		break;
+	}
+	
+	if (success) {
+		forwarder->reconnections++;
+	}
+	
+	return success;
+}
+
+/* Drop the first n messages of the pending buffer */
+static void consume_pending(struct syslog_forwarder *forwarder, unsigned int n, size_t bytes)
+{
+	forwarder->count -= n;
+	forwarder->pending_len -= bytes;
+	memmove(forwarder->pending, forwarder->pending + bytes, forwarder->pending_len);
+	memmove(forwarder->lengths, forwarder->lengths + n,
+	        forwarder->count * sizeof(*forwarder->lengths));
+}
+
+/* Send pending datagrams, a datagram the socket refuses is dropped */
+static void send_udp(struct syslog_forwarder *forwarder)
+{
+	size_t offset = 0;
+	unsigned int i = 0;
+	
+	while (i < forwarder->count) {
+		unsigned int n = forwarder->count - i;
+		size_t pos = offset;
+		unsigned int j;
+		int sent;
+		
+		if (n > UDP_BATCH)
+			n = UDP_BATCH;
+		
+		for (j = 0; j < n; j++) {
+			forwarder->iov[j].iov_base = forwarder->pending + pos;
+			forwarder->iov[j].iov_len = forwarder->lengths[i + j];
+			pos += forwarder->lengths[i + j];
+			
+			memset(&forwarder->msgs[j], 0, sizeof(forwarder->msgs[j]));
+			forwarder->msgs[j].msg_hdr.msg_iov = &forwarder->iov[j];
+			forwarder->msgs[j].msg_hdr.msg_iovlen = 1;
+		}
+		
+		sent = sendmmsg(forwarder->sock, forwarder->msgs, n, 0);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			
+			/* The first datagram failed, e.g. on an ICMP error of an earlier one */
+			forwarder->messages_failed++;
+			sent = 1;
+		} else {
+			forwarder->messages_sent += (uint64_t)sent;
+		}
+		
+		for (j = 0; j < (unsigned int)sent; j++)
+			offset += forwarder->lengths[i + j];
+		i += (unsigned int)sent;
+	}
+	
+	forwarder->count = 0;
+	forwarder->pending_len = 0;
+}
+
+/* Write to the stream, returns bytes written or -1 on error */
+static ssize_t stream_write(struct syslog_forwarder *forwarder, const char *data, size_t len)
+{
+	ssize_t n;
+	
+	switch (forwarder->config.transport) {
+	case SYSLOG_TRANSPORT_TCP:
+		do {
+			n = send(forwarder->sock, data, len, MSG_NOSIGNAL);
+		} while (n < 0 && errno == EINTR);
+		return n;
+		
+	case SYSLOG_TRANSPORT_TLS:
+#ifdef ENABLE_TLS
+		if (forwarder->ssl) {
+			n = SSL_write(forwarder->ssl, data, (int)len);
+			return n > 0 ? n : -1;
+		}
+#endif
+		return -1;
+		
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Write pending frames to the stream. On error the connection is closed
+ * and the frames not fully written stay pending for the next connection.
+ */
+static bool send_stream(struct syslog_forwarder *forwarder)
+{
+	size_t written = 0, done_bytes = 0;
+	unsigned int done = 0;
+	bool success = true;
+	
+	while (written < forwarder->pending_len) {
+		ssize_t n = stream_write(forwarder, forwarder->pending + written,
+		                         forwarder->pending_len - written);
+		
+		if (n <= 0) {
+			success = false;
+			break;
+		}
+		written += (size_t)n;
+	}
+	
+	while (done < forwarder->count && done_bytes + forwarder->lengths[done] <= written)
+		done_bytes += forwarder->lengths[done++];
+	
+	forwarder->messages_sent += done;
+	consume_pending(forwarder, done, done_bytes);
+	
+	if (!success)
+		close_connection(forwarder);
+	
+	return success;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Send pending messages, connecting first if it is time to retry */
+static bool flush_locked(struct syslog_forwarder *forwarder)
+{
+	unsigned int count = forwarder->count;
+	uint64_t start, end;
+	bool ok = true;
+	
+	if (count == 0)
+		return true;
+	
+	if (!forwarder->connected) {
+		if (!forwarder->config.reconnect ||
+		    time(NULL) - forwarder->last_attempt < (time_t)forwarder->config.reconnect_interval)
+			return false;
+		if (!reconnect_locked(forwarder))
+			return false;
+	}
+	
+	start = now_ns();
+	if (forwarder->config.transport == SYSLOG_TRANSPORT_UDP)
+		send_udp(forwarder);
+	else
+		ok = send_stream(forwarder);
+	end = now_ns();
+	
+	/* What a failed write left waits on with the next batch */
+	if (forwarder->count < count)
+		adaptive_batch_record(forwarder->batcher, count - forwarder->count,
+		                      start - forwarder->first_ns, end - start, end);
+	
+	return ok;
+}
+
 struct syslog_forwarder *syslog_forwarder_create(struct syslog_config *config)
 {
+	struct adaptive_batch_config batching = { 0 };
 	struct syslog_forwarder *forwarder;
 	
 	if (!config || !config->server)
@@ -243,6 +508,37 @@ struct syslog_forwarder *syslog_forwarder_create(struct syslog_config *config)
 		forwarder->config.tls_ca = strdup(config->tls_ca);
 #endif
 	
+	/* The same for every message */
+	snprintf(forwarder->origin, sizeof(forwarder->origin), "%s %s - ",
+	         forwarder->hostname, forwarder->config.app_name);
+	
+	/* Pending buffer, large enough for a batch of the largest messages */
+	batching.max_size = config->batch_size ? config->batch_size : SYSLOG_BATCH_DEFAULT;
+	batching.target_us = (uint64_t)config->batch_latency_ms * 1000;
+	forwarder->batcher = adaptive_batch_create("syslog", &batching);
+	forwarder->pending_size = config->buffer_size ? config->buffer_size : SYSLOG_BUFFER_DEFAULT;
+	if (forwarder->pending_size < MAX_SYSLOG_MSG_SIZE + FRAME_PREFIX_SIZE)
+		forwarder->pending_size = MAX_SYSLOG_MSG_SIZE + FRAME_PREFIX_SIZE;
+	forwarder->max_count = forwarder->pending_size / MIN_MESSAGE_SIZE;
+	
+	forwarder->pending = malloc(forwarder->pending_size);
+	forwarder->lengths = malloc(forwarder->max_count * sizeof(*forwarder->lengths));
+	if (!forwarder->pending || !forwarder->lengths || !forwarder->batcher) {
+		adaptive_batch_destroy(forwarder->batcher);
+		free(forwarder->pending);
+		free(forwarder->lengths);
+		free((void *)forwarder->config.server);
+		free((void *)forwarder->config.hostname);
+		free((void *)forwarder->config.app_name);
+#ifdef ENABLE_TLS
+		free((void *)forwarder->config.tls_cert);
+		free((void *)forwarder->config.tls_key);
+		free((void *)forwarder->config.tls_ca);
+#endif
+		free(forwarder);
+		return NULL;
+	}
+	
 	pthread_mutex_init(&forwarder->lock, NULL);
 	forwarder->sock = -1;
 	
@@ -257,17 +553,13 @@ void syslog_forwarder_destroy(struct syslog_forwarder *forwarder)
 	if (!forwarder)
 		return;
 	
-#ifdef ENABLE_TLS
-	if (forwarder->ssl) {
-		SSL_shutdown(forwarder->ssl);
-		SSL_free(forwarder->ssl);
-	}
-	if (forwarder->ssl_ctx)
-		SSL_CTX_free(forwarder->ssl_ctx);
-#endif
+	/* Last attempt for what is still pending */
+	pthread_mutex_lock(&forwarder->lock);
+	if (forwarder->connected)
+		flush_locked(forwarder);
+	pthread_mutex_unlock(&forwarder->lock);
 	
-	if (forwarder->sock >= 0)
-		close(forwarder->sock);
+	close_connection(forwarder);
 	
 	free((void *)forwarder->config.server);
 	free((void *)forwarder->config.hostname);
@@ -278,6 +570,9 @@ void syslog_forwarder_destroy(struct syslog_forwarder *forwarder)
 	free((void *)forwarder->config.tls_ca);
 #endif
 	
+	adaptive_batch_destroy(forwarder->batcher);
+	free(forwarder->pending);
+	free(forwarder->lengths);
 	pthread_mutex_destroy(&forwarder->lock);
 	free(forwarder);
 }
@@ -285,22 +580,23 @@ void syslog_forwarder_destroy(struct syslog_forwarder *forwarder)
 bool syslog_forwarder_send(struct syslog_forwarder *forwarder,
                            struct syslog_message *msg)
 {
-	char buffer[MAX_SYSLOG_MSG_SIZE];
-	char timestamp[64];
+	bool stream;
+	char *frame;
 	int priority;
-	ssize_t len, sent;
-	bool success = false;
+	ssize_t len;
+	long usec;
 	
 	if (!forwarder || !msg || !msg->message)
 		return false;
 	
 	pthread_mutex_lock(&forwarder->lock);
 	
-	if (!forwarder->connected) {
-		if (forwarder->config.reconnect) {
-			syslog_forwarder_reconnect(forwarder);
-		}
-		if (!forwarder->connected) {
+	/* Make room by sending, the message is dropped if that fails */
+	if (forwarder->pending_size - forwarder->pending_len < MAX_SYSLOG_MSG_SIZE + FRAME_PREFIX_SIZE ||
+	    forwarder->count == forwarder->max_count) {
+		flush_locked(forwarder);
+		if (forwarder->pending_size - forwarder->pending_len < MAX_SYSLOG_MSG_SIZE + FRAME_PREFIX_SIZE ||
+		    forwarder->count == forwarder->max_count) {
 			forwarder->messages_failed++;
 			pthread_mutex_unlock(&forwarder->lock);
 			return false;
@@ -309,74 +605,60 @@ bool syslog_forwarder_send(struct syslog_forwarder *forwarder,
 	
 	/* Calculate priority */
 	priority = (forwarder->config.facility << 3) | msg->severity;
+	usec = update_timestamp(forwarder);
+	
+	/* Streams get an octet-counted frame, the digits are filled in below */
+	stream = forwarder->config.transport != SYSLOG_TRANSPORT_UDP;
+	frame = forwarder->pending + forwarder->pending_len;
 	
 	/* Format RFC 5424 message */
-	format_rfc5424_timestamp(timestamp, sizeof(timestamp));
-	
-	len = snprintf(buffer, sizeof(buffer),
-	              "<%d>1 %s %s %s - %s %s %s\n",
-	              priority,
-	              timestamp,
-	              forwarder->hostname,
-	              forwarder->config.app_name,
-	              msg->msg_id ? msg->msg_id : "-",
-	              msg->structured_data ? msg->structured_data : "-",
-	              msg->message);
-	
-	if (len >= (ssize_t)sizeof(buffer)) {
-		len = sizeof(buffer) - 1;
+	len = snprintf(frame + (stream ? FRAME_PREFIX_SIZE : 0), MAX_SYSLOG_MSG_SIZE,
+	               "<%d>1 %s%06ldZ %s%s %s %s",
+	               priority,
+	               forwarder->stamp,
+	               usec,
+	               forwarder->origin,
+	               msg->msg_id ? msg->msg_id : "-",
+	               msg->structured_data ? msg->structured_data : "-",
+	               msg->message);
+	
+	if (len >= MAX_SYSLOG_MSG_SIZE) {
+		len = MAX_SYSLOG_MSG_SIZE - 1;
 	}
 	
-	/* Send message */
-	switch (forwarder->config.transport) {
-	case SYSLOG_TRANSPORT_UDP:
-		sent = send(forwarder->sock, buffer, len, 0);
-		success = (sent == len);
-		break;
+	if (stream) {
+		char prefix[FRAME_PREFIX_SIZE + 1];
+		int prefix_len = snprintf(prefix, sizeof(prefix), "%zd ", len);
 		
-	case SYSLOG_TRANSPORT_TCP:
-		sent = send(forwarder->sock, buffer, len, 0);
-		if (sent != len) {
-			forwarder->connected = false;
-			close(forwarder->sock);
-			forwarder->sock = -1;
-		} else {
-			success = true;
-		}
-		break;
-		
-	case SYSLOG_TRANSPORT_TLS:
-#ifdef ENABLE_TLS
-		if (forwarder->ssl) {
-			sent = SSL_write(forwarder->ssl, buffer, len);
-			if (sent != len) {
-				forwarder->connected = false;
-				SSL_shutdown(forwarder->ssl);
-				SSL_free(forwarder->ssl);
-				SSL_CTX_free(forwarder->ssl_ctx);
-				close(forwarder->sock);
-				forwarder->sock = -1;
-				forwarder->ssl = NULL;
-				forwarder->ssl_ctx = NULL;
-			} else {
-				success = true;
-			}
-		}
-#else
-		/* TLS not supported in this build */
-		success = false;
-#endif
-		break;
+		memmove(frame + prefix_len, frame + FRAME_PREFIX_SIZE, (size_t)len);
+		memcpy(frame, prefix, (size_t)prefix_len);
+		len += prefix_len;
 	}
 	
-	if (success) {
-		forwarder->messages_sent++;
-	} else {
-		forwarder->messages_failed++;
-	}
+	if (forwarder->count == 0)
+		forwarder->first_ns = now_ns();
+	forwarder->lengths[forwarder->count++] = (uint32_t)len;
+	forwarder->pending_len += (size_t)len;
+	
+	if (forwarder->count >= adaptive_batch_size(forwarder->batcher))
+		flush_locked(forwarder);
 	
 	pthread_mutex_unlock(&forwarder->lock);
 	
+	return true;
+}
+
+bool syslog_forwarder_flush(struct syslog_forwarder *forwarder)
+{
+	bool success;
+	
+	if (!forwarder)
+		return false;
+	
+	pthread_mutex_lock(&forwarder->lock);
+	success = flush_locked(forwarder);
+	pthread_mutex_unlock(&forwarder->lock);
+	
 	return success;
 }
 
@@ -396,55 +678,17 @@ bool syslog_forwarder_is_connected(struct syslog_forwarder *forwarder)
 
 bool syslog_forwarder_reconnect(struct syslog_forwarder *forwarder)
 {
-	bool success = false;
+	bool success;
 	
 	if (!forwarder)
 		return false;
 	
 	pthread_mutex_lock(&forwarder->lock);
 	
-	/* Close existing connection */
-	if (forwarder->sock >= 0) {
-#ifdef ENABLE_TLS
-		if (forwarder->ssl) {
-			SSL_shutdown(forwarder->ssl);
-			SSL_free(forwarder->ssl);
-			forwarder->ssl = NULL;
-		}
-		if (forwarder->ssl_ctx) {
-			SSL_CTX_free(forwarder->ssl_ctx);
-			forwarder->ssl_ctx = NULL;
-		}
-#endif
-		close(forwarder->sock);
-		forwarder->sock = -1;
-	}
-	
-	forwarder->connected = false;
-	
-	/* Attempt reconnection */
-	switch (forwarder->config.transport) {
-	case SYSLOG_TRANSPORT_UDP:
-		success = connect_udp(forwarder);
-		break;
-		
-	case SYSLOG_TRANSPORT_TCP:
-		success = connect_tcp(forwarder);
-		break;
-		
-	case SYSLOG_TRANSPORT_TLS:
-#ifdef ENABLE_TLS
-		success = connect_tls(forwarder);
-#else
-		/* TLS not supported in this build */
-		success = false;
-#endif
-		break;
-	}
-	
-	if (success) {
-		forwarder->reconnections++;
-	}
+	/* Messages held while disconnected go out on the new connection */
+	success = reconnect_locked(forwarder);
+	if (success)
+		flush_locked(forwarder);
 	
 	pthread_mutex_unlock(&forwarder->lock);
 	
@@ -26,6 +26,7 @@ static struct {
     uint64_t event_count;
     uint64_t bytes_written;
     uint64_t rotate_size;
+    long file_size;
     int include_header;
     int file_number;
     nlmon_plugin_context_t *ctx;
@@ -66,9 +67,12 @@ static int rotate_csv_file(void) {
         return -1;
     }
     
+    state.file_size = 0;
+    
     /* Write header if enabled */
     if (state.include_header) {
-        fprintf(state.csvfile, "%s\n", state.fields);
+        int written = fprintf(state.csvfile, "%s\n", state.fields);
+        if (written > 0) state.file_size += written;
         fflush(state.csvfile);
     }
     
@@ -79,7 +83,8 @@ static int rotate_csv_file(void) {
 static void write_csv_header(void) {
     if (!state.csvfile || !state.include_header) return;
     
-    fprintf(state.csvfile, "%s\n", state.fields);
+    int written = fprintf(state.csvfile, "%s\n", state.fields);
+    if (written > 0) state.file_size += written;
     fflush(state.csvfile);
 }
 
@@ -115,7 +120,8 @@ static int csv_exporter_init(nlmon_plugin_context_t *ctx) {
     }
     
     /* Write header if file is empty */
-    if (get_file_size(state.csvfile) == 0) {
+    state.file_size = get_file_size(state.csvfile);
+    if (state.file_size == 0) {
         write_csv_header();
     }
     
@@ -142,36 +148,74 @@ static void csv_exporter_cleanup(void) {
     }
 }
 
-/* Export event to CSV */
-static int csv_exporter_on_event(struct nlmon_event *event) {
-    if (!state.csvfile || !event) {
+/* Export a batch of events to CSV
+ *
+ * All rows of the batch are formatted into one buffer and written with a
+ * single call, and rotation is checked once per batch. The events are
+ * only read during the call, as the plugin API requires.
+ */
+static int csv_exporter_on_events(const struct nlmon_event *const *events, size_t count) {
+    char buf[8192];
+    size_t len = 0;
+    uint64_t first = state.event_count;
+    time_t now;
+    
+    if (!state.csvfile || !events) {
         return -1;
     }
     
-    state.event_count++;
-    
-    /* Write CSV row - simplified example */
-    time_t now = time(NULL);
-    int written = fprintf(state.csvfile, "%ld,event_%lu,network_event\n",
-                         now, state.event_count);
+    /* Write CSV rows - simplified example */
+    now = time(NULL);
+    for (size_t i = 0; i < count; i++) {
+        int n;
+        
+        if (!events[i]) continue;
+        
+        state.event_count++;
+        n = snprintf(buf + len, sizeof(buf) - len, "%ld,event_%lu,network_event\n",
+                     (long)now, state.event_count);
+        if (n < 0) continue;
+        
+        /* Buffer full: write it out and format the row again */
+        if ((size_t)n >= sizeof(buf) - len) {
+            state.bytes_written += fwrite(buf, 1, len, state.csvfile);
+            state.file_size += len;
+            len = 0;
+            n = snprintf(buf, sizeof(buf), "%ld,event_%lu,network_event\n",
+                         (long)now, state.event_count);
+        }
+        len += n;
+    }
     
-    if (written > 0) {
-        state.bytes_written += written;
+    if (len > 0) {
+        state.bytes_written += fwrite(buf, 1, len, state.csvfile);
+        state.file_size += len;
     }
     
     /* Check if rotation needed */
-    if (get_file_size(state.csvfile) >= (long)state.rotate_size) {
+    if (state.file_size >= (long)state.rotate_size) {
         rotate_csv_file();
     }
     
     /* Flush every 100 events */
-    if (state.event_count % 100 == 0) {
+    if (state.csvfile && state.event_count / 100 != first / 100) {
         fflush(state.csvfile);
     }
     
     return 0;
 }
 
+/* Export event to CSV, for nlmon versions without batch delivery */
+static int csv_exporter_on_event(struct nlmon_event *event) {
+    const struct nlmon_event *view = event;
+    
+    if (!event) {
+        return -1;
+    }
+    
+    return csv_exporter_on_events(&view, 1);
+}
+
 /* Handle custom command */
 static int csv_exporter_on_command(const char *cmd, const char *args, 
                                    char *response, size_t resp_len) {
@@ -180,7 +224,7 @@ static int csv_exporter_on_command(const char *cmd, const char *args,
     }
     
     if (strcmp(cmd, "csv_stats") == 0) {
-        long file_size = get_file_size(state.csvfile);
+        long file_size = state.file_size;
         snprintf(response, resp_len,
                 "CSV Exporter Statistics:\n"
                 "  Output file: %s\n"
@@ -239,6 +283,7 @@ static nlmon_plugin_t csv_exporter_plugin = {
         .init = csv_exporter_init,
         .cleanup = csv_exporter_cleanup,
         .on_event = csv_exporter_on_event,
+        .on_events = csv_exporter_on_events,
         .on_command = csv_exporter_on_command,
         .on_config_reload = csv_exporter_on_config_reload,
     },
@@ -289,11 +289,23 @@ static nlmon_plugin_t template_plugin = {
     /* Event filter (optional) */
     .event_filter = template_event_filter,  /* Set to NULL to process all events */
     
+    /* Interest (optional) - events outside it never reach the plugin */
+    .interest = NULL,
+    /* Example, link events only:
+     *   static const uint16_t types[] = {RTM_NEWLINK, RTM_DELLINK, 0};
+     *   static const int protocols[] = {NETLINK_ROUTE, -1};
+     *   static const nlmon_plugin_interest_t interest = {
+     *       .protocols = protocols,
+     *       .msg_types = types,
+     *   };
+     *   .interest = &interest,
+     */
+    
     /* Plugin flags */
     .flags = NLMON_PLUGIN_FLAG_NONE,
     /* Available flags:
      *   NLMON_PLUGIN_FLAG_NONE        - Default behavior
-     *   NLMON_PLUGIN_FLAG_PROCESS_ALL - Receive all events (ignore filter)
+     *   NLMON_PLUGIN_FLAG_PROCESS_ALL - Receive all events (ignore filter and interest)
      *   NLMON_PLUGIN_FLAG_ASYNC       - Async event processing
      *   NLMON_PLUGIN_FLAG_CRITICAL    - Plugin failure stops nlmon
      */
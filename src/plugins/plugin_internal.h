@@ -3,9 +3,51 @@
 
 #include "plugin_api.h"
 #include "plugin_manager.h"
+#include <stdatomic.h>
 
 #define MAX_PLUGINS 64
 
+/* Most events handed to one on_events call */
+#define PLUGIN_BATCH_MAX 256
+
+/* Worker defaults, see nlmon_plugin_t */
+#define PLUGIN_DEFAULT_BUDGET_US 10000
+#define PLUGIN_DEFAULT_QUEUE     1024
+
+/* Dispatch table dimensions */
+#define PLUGIN_DISPATCH_PROTOCOLS 32    /* NETLINK_* protocols, like MAX_LINKS */
+#define PLUGIN_DISPATCH_TYPES     256   /* The last entry covers all higher types */
+
+struct plugin_worker;
+struct filter_bytecode;
+struct nlmon_event;
+
+/* Dispatch table, built from the plugins' interests
+ *
+ * Bit i of each mask stands for plugins[i]. An event is looked at only by
+ * the plugins in both the mask of its protocol and that of its message
+ * type; the exact checks are left for the few plugins in the check masks.
+ */
+struct plugin_dispatch {
+    uint64_t by_protocol[PLUGIN_DISPATCH_PROTOCOLS + 1];   /* Last for other protocols */
+    uint64_t by_msg_type[PLUGIN_DISPATCH_TYPES];
+    uint64_t check_msg_type;    /* Types past the table to compare exactly */
+    uint64_t check_family;      /* Generic netlink families to compare */
+    uint64_t check_filter;      /* Filter expressions to evaluate */
+};
+
+/* Plugins as routing sees them
+ *
+ * Never modified once published. Changes publish a new table and free
+ * the old one after a grace period, so routing walks it without a lock
+ * and a plugin is cleaned up only once no routing call can reach it.
+ */
+struct plugin_table {
+    size_t count;
+    struct plugin_handle *plugins[MAX_PLUGINS];
+    struct plugin_dispatch dispatch;
+};
+
 /* Internal plugin handle structure */
 typedef struct plugin_handle {
     char name[NLMON_PLUGIN_NAME_MAX];
@@ -16,7 +58,12 @@ typedef struct plugin_handle {
     int error_count;
     uint64_t events_processed;
     uint64_t events_filtered;
+    uint64_t batches_processed;
+    int batched;                /* Has on_events, used instead of on_event */
+    struct plugin_worker *worker;   /* NULL for inline plugins */
+    struct filter_bytecode *interest_filter;   /* Compiled interest->filter */
     nlmon_plugin_context_t *context;
+    int image_fd;               /* Copy dlopen()ed by a hot reload, or -1 */
 } plugin_handle_t;
 
 /* Plugin manager structure */
@@ -25,10 +72,32 @@ typedef struct plugin_manager {
     plugin_handle_t *plugins[MAX_PLUGINS];
     size_t plugin_count;
     int initialized;
+    
+    /* Routing table, read under an epoch, replaced by the control thread */
+    _Atomic(struct plugin_table *) table;
+    atomic_uint table_epoch;
+    atomic_ulong table_readers[2];  /* Routing calls inside each epoch parity */
 } plugin_manager_t;
 
 /* Internal functions shared between plugin modules */
 plugin_handle_t *find_plugin(plugin_manager_t *mgr, const char *name);
+plugin_handle_t *plugin_open(plugin_manager_t *mgr, const char *name, int copy);
+void plugin_close(plugin_handle_t *handle);
 int check_dependencies(plugin_manager_t *mgr, plugin_handle_t *handle);
 
+/* Routing table (plugin_loader.c), republished whenever plugins[] changes.
+ * plugin_dispatch_rebuild() returns once routing no longer sees the
+ * previous table, or -1 with the previous one kept if out of memory. */
+int plugin_dispatch_rebuild(plugin_manager_t *mgr);
+uint64_t plugin_dispatch_select(const struct plugin_table *table, struct nlmon_event *event);
+unsigned int plugin_table_enter(plugin_manager_t *mgr);
+void plugin_table_exit(plugin_manager_t *mgr, unsigned int parity);
+
+/* Plugin workers (plugin_worker.c) */
+int plugin_worker_start(plugin_handle_t *handle);
+void plugin_worker_stop(plugin_handle_t *handle);
+void plugin_worker_drain(plugin_handle_t *handle);
+int plugin_worker_submit(plugin_handle_t *handle, struct nlmon_event *event);
+void plugin_worker_info(plugin_handle_t *handle, plugin_info_t *info);
+
 #endif /* PLUGIN_INTERNAL_H */
@@ -1,7 +1,43 @@
 #include "plugin_internal.h"
+#include "filter_predicate.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+
+_Static_assert((int)NLMON_PREDICATE_ARG_STRING == (int)FILTER_PREDICATE_ARG_STRING &&
+               (int)NLMON_PREDICATE_ARG_NUMBER == (int)FILTER_PREDICATE_ARG_NUMBER,
+               "predicate argument types differ");
+
+/* Plugin whose init is running, owns the predicates it registers */
+static plugin_handle_t *initializing;
+
+/* Version a hot reload replaces, whose predicates the new one takes over */
+static plugin_handle_t *replacing;
+
+static int register_predicate(const char *name, nlmon_filter_predicate_t fn,
+                              nlmon_predicate_arg_t arg, uint32_t cost_ns, void *data) {
+    if (!initializing) return -EPERM;
+    
+    int ret = filter_predicate_register(name, fn, (enum filter_predicate_arg)arg,
+                                        cost_ns, data, initializing);
+    if (ret == -EEXIST && replacing) {
+        ret = filter_predicate_replace(name, fn, (enum filter_predicate_arg)arg,
+                                       cost_ns, data, replacing, initializing);
+        if (ret == -ENOENT) ret = -EEXIST;
+    }
+    return ret < 0 ? ret : 0;
+}
+
+/* Drop a plugin's predicates before its cleanup frees what they use */
+static void cleanup_plugin(plugin_handle_t *handle) {
+    filter_predicate_unregister_owner(handle);
+    
+    if (handle->state == PLUGIN_STATE_INITIALIZED &&
+        handle->plugin->callbacks.cleanup) {
+        handle->plugin->callbacks.cleanup();
+    }
+}
 
 /* Initialize a single plugin */
 static int init_plugin(plugin_handle_t *handle, nlmon_plugin_context_t *ctx) {
@@ -23,12 +59,18 @@ static int init_plugin(plugin_handle_t *handle, nlmon_plugin_context_t *ctx) {
     
     /* Store context */
     handle->context = ctx;
+    if (!ctx->register_predicate) {
+        ctx->register_predicate = register_predicate;
+    }
     
     /* Call init callback if provided */
     if (handle->plugin->callbacks.init) {
+        initializing = handle;
         int ret = handle->plugin->callbacks.init(ctx);
+        initializing = NULL;
         if (ret != 0) {
             fprintf(stderr, "Plugin %s initialization failed: %d\n", handle->name, ret);
+            filter_predicate_unregister_owner(handle);
             handle->state = PLUGIN_STATE_ERROR;
             handle->error_count++;
             
@@ -41,8 +83,13 @@ static int init_plugin(plugin_handle_t *handle, nlmon_plugin_context_t *ctx) {
         }
     }
     
+    /* Events are delivered on a worker of the plugin's own */
+    if (plugin_worker_start(handle) != 0) {
+        fprintf(stderr, "Plugin %s runs inline, worker unavailable\n", handle->name);
+    }
+    
     handle->state = PLUGIN_STATE_INITIALIZED;
-    printf("Initialized plugin: %s\n", handle->name);
+    printf("Initialized plugin: %s%s\n", handle->name, handle->worker ? "" : " (inline)");
     
     return 0;
 }
@@ -120,11 +167,13 @@ void plugin_manager_cleanup_all(plugin_manager_t *mgr) {
     for (int i = (int)mgr->plugin_count - 1; i >= 0; i--) {
         plugin_handle_t *handle = mgr->plugins[i];
         
+        plugin_worker_stop(handle);
+        
         if (handle->state == PLUGIN_STATE_INITIALIZED &&
             handle->plugin->callbacks.cleanup) {
             printf("Cleaning up plugin: %s\n", handle->name);
-            handle->plugin->callbacks.cleanup();
         }
+        cleanup_plugin(handle);
         
         handle->state = PLUGIN_STATE_UNLOADED;
     }
@@ -162,10 +211,8 @@ int plugin_manager_disable(plugin_manager_t *mgr, const char *name) {
     }
     
     /* Cleanup if initialized */
-    if (handle->state == PLUGIN_STATE_INITIALIZED &&
-        handle->plugin->callbacks.cleanup) {
-        handle->plugin->callbacks.cleanup();
-    }
+    plugin_worker_stop(handle);
+    cleanup_plugin(handle);
     
     handle->state = PLUGIN_STATE_DISABLED;
     printf("Disabled plugin: %s\n", name);
@@ -184,10 +231,8 @@ int plugin_manager_reload(plugin_manager_t *mgr, const char *name, nlmon_plugin_
     }
     
     /* Cleanup if initialized */
-    if (handle->state == PLUGIN_STATE_INITIALIZED &&
-        handle->plugin->callbacks.cleanup) {
-        handle->plugin->callbacks.cleanup();
-    }
+    plugin_worker_stop(handle);
+    cleanup_plugin(handle);
     
     /* Re-initialize */
     handle->state = PLUGIN_STATE_LOADED;
@@ -202,6 +247,87 @@ int plugin_manager_reload(plugin_manager_t *mgr, const char *name, nlmon_plugin_
     return ret;
 }
 
+/* Swap a plugin for a fresh load of its file, without pausing routing
+ *
+ * The new version is loaded from a copy of the file and initialized while
+ * the old one still gets events, then takes the old one's place in a new
+ * routing table. Once no routing call can reach the old version its
+ * worker delivers what it has queued, and it is cleaned up and unloaded.
+ */
+int plugin_manager_hot_reload(plugin_manager_t *mgr, const char *name, nlmon_plugin_context_t *ctx) {
+    if (!mgr || !name || !ctx) return -1;
+    
+    plugin_handle_t *old = NULL;
+    size_t index = 0;
+    
+    for (size_t i = 0; i < mgr->plugin_count; i++) {
+        if (strcmp(mgr->plugins[i]->name, name) == 0) {
+            old = mgr->plugins[i];
+            index = i;
+            break;
+        }
+    }
+    
+    if (!old) {
+        fprintf(stderr, "Plugin not found: %s\n", name);
+        return -1;
+    }
+    
+    plugin_handle_t *handle = plugin_open(mgr, name, 1);
+    if (!handle) {
+        fprintf(stderr, "Failed to reload plugin: %s\n", name);
+        return -1;
+    }
+    
+    /* Only a running plugin is started, a disabled one stays disabled */
+    if (old->state == PLUGIN_STATE_INITIALIZED) {
+        replacing = old;
+        int ret = init_plugin(handle, old->context ? old->context : ctx);
+        replacing = NULL;
+        
+        if (ret != 0) {
+            fprintf(stderr, "Failed to reload plugin: %s\n", name);
+            filter_predicate_unregister_owner(handle);
+            plugin_close(handle);
+            return -1;
+        }
+        
+        /* State handover, while the old version still runs */
+        if (handle->plugin->callbacks.on_config_reload) {
+            ret = handle->plugin->callbacks.on_config_reload(handle->context);
+            if (ret != 0) {
+                fprintf(stderr, "Plugin %s state handover failed: %d\n", name, ret);
+                handle->error_count++;
+            }
+        }
+    } else if (old->state == PLUGIN_STATE_DISABLED) {
+        handle->state = PLUGIN_STATE_DISABLED;
+    }
+    
+    mgr->plugins[index] = handle;
+    if (plugin_dispatch_rebuild(mgr) != 0) {
+        mgr->plugins[index] = old;
+        plugin_worker_stop(handle);
+        cleanup_plugin(handle);
+        plugin_close(handle);
+        return -1;
+    }
+    
+    /* Routing no longer reaches the old version */
+    plugin_worker_drain(old);
+    cleanup_plugin(old);
+    
+    handle->events_processed += old->events_processed;
+    handle->events_filtered += old->events_filtered;
+    handle->batches_processed += old->batches_processed;
+    
+    printf("Hot reloaded plugin: %s v%s -> v%s\n", name,
+           old->plugin->version, handle->plugin->version);
+    plugin_close(old);
+    
+    return 0;
+}
+
 /* Notify plugins of config reload */
 int plugin_manager_notify_config_reload(plugin_manager_t *mgr, nlmon_plugin_context_t *ctx) {
     if (!mgr || !ctx) return -1;
@@ -1,10 +1,23 @@
+#define _GNU_SOURCE
 #include "plugin_internal.h"
+#include "event_processor.h"
+#include "filter_parser.h"
+#include "filter_compiler.h"
+#include "filter_cache.h"
+#include "filter_eval.h"
+#include "filter_predicate.h"
+#include "stats_bus.h"
+#include <linux/netlink.h>
 #include <dlfcn.h>
 #include <dirent.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
 #include <errno.h>
 
 #define PLUGIN_EXT ".so"
@@ -24,6 +37,10 @@ plugin_manager_t *plugin_manager_create(const char *plugin_dir) {
     
     mgr->plugin_count = 0;
     mgr->initialized = 0;
+    atomic_init(&mgr->table, NULL);
+    atomic_init(&mgr->table_epoch, 0);
+    atomic_init(&mgr->table_readers[0], 0);
+    atomic_init(&mgr->table_readers[1], 0);
     
     return mgr;
 }
@@ -37,13 +54,11 @@ void plugin_manager_destroy(plugin_manager_t *mgr) {
     
     for (size_t i = 0; i < mgr->plugin_count; i++) {
         if (mgr->plugins[i]) {
-            if (mgr->plugins[i]->dl_handle) {
-                dlclose(mgr->plugins[i]->dl_handle);
-            }
-            free(mgr->plugins[i]);
+            plugin_close(mgr->plugins[i]);
         }
     }
     
+    free(atomic_load(&mgr->table));
     free(mgr);
 }
 
@@ -59,6 +74,30 @@ static int is_plugin_file(const char *filename) {
     return strcmp(filename + len - ext_len, PLUGIN_EXT) == 0;
 }
 
+/* Compile the filter expression of a plugin's interest */
+static int compile_interest(plugin_handle_t *handle) {
+    const nlmon_plugin_interest_t *interest = handle->plugin->interest;
+    
+    if (!interest || !interest->filter || !interest->filter[0]) {
+        return 0;
+    }
+    
+    struct filter_parse_error error = { .message = "" };
+    
+    handle->interest_filter = filter_cache_get(interest->filter, &error);
+    if (!handle->interest_filter) {
+        if (error.message[0]) {
+            fprintf(stderr, "Plugin %s interest filter: %s at column %zu\n",
+                    handle->name, error.message, error.column);
+        } else {
+            fprintf(stderr, "Plugin %s interest filter could not be compiled\n", handle->name);
+        }
+        return -1;
+    }
+    
+    return 0;
+}
+
 /* Discover plugins in directory */
 int plugin_manager_discover(plugin_manager_t *mgr) {
     if (!mgr) return -1;
@@ -113,15 +152,45 @@ int plugin_manager_discover(plugin_manager_t *mgr) {
     return discovered;
 }
 
-/* Load a specific plugin */
-plugin_handle_t *plugin_manager_load(plugin_manager_t *mgr, const char *name) {
-    if (!mgr || !name) return NULL;
+/* Copy a plugin into an anonymous file, for a second dlopen() of it
+ *
+ * dlopen() hands out the loaded instance again for a path it has seen, so
+ * a hot reload opens the copy through /proc instead. The file stays open
+ * while the copy is loaded, which keeps its path unique.
+ */
+static int copy_image(const char *path, const char *name, char *image, size_t len) {
+    char buf[65536];
+    ssize_t n;
+    int in, out;
+    
+    in = open(path, O_RDONLY | O_CLOEXEC);
+    if (in < 0) return -1;
+    
+    out = memfd_create(name, MFD_CLOEXEC);
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
     
-    if (mgr->plugin_count >= MAX_PLUGINS) {
-        fprintf(stderr, "Maximum number of plugins reached\n");
-        return NULL;
+    while ((n = read(in, buf, sizeof(buf))) > 0) {
+        if (write(out, buf, (size_t)n) != n) {
+            n = -1;
+            break;
+        }
+    }
+    close(in);
+    
+    if (n < 0) {
+        close(out);
+        return -1;
     }
     
+    snprintf(image, len, "/proc/self/fd/%d", out);
+    return out;
+}
+
+/* Open a plugin without adding it, from a copy of its file if copy is set */
+plugin_handle_t *plugin_open(plugin_manager_t *mgr, const char *name, int copy) {
     /* Build plugin path */
     char path[512];
     snprintf(path, sizeof(path), "%s/%s%s", mgr->plugin_dir, name, PLUGIN_EXT);
@@ -143,12 +212,26 @@ plugin_handle_t *plugin_manager_load(plugin_manager_t *mgr, const char *name) {
     strncpy(handle->name, name, sizeof(handle->name) - 1);
     strncpy(handle->path, path, sizeof(handle->path) - 1);
     handle->state = PLUGIN_STATE_UNLOADED;
+    handle->image_fd = -1;
     
     /* Load shared library */
-    handle->dl_handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    char image[64];
+    const char *load_path = path;
+    
+    if (copy) {
+        handle->image_fd = copy_image(path, name, image, sizeof(image));
+        if (handle->image_fd < 0) {
+            fprintf(stderr, "Failed to copy plugin %s: %s\n", name, strerror(errno));
+            free(handle);
+            return NULL;
+        }
+        load_path = image;
+    }
+    
+    handle->dl_handle = dlopen(load_path, RTLD_NOW | RTLD_LOCAL);
     if (!handle->dl_handle) {
         fprintf(stderr, "Failed to load plugin %s: %s\n", name, dlerror());
-        free(handle);
+        plugin_close(handle);
         return NULL;
     }
     
@@ -162,8 +245,7 @@ plugin_handle_t *plugin_manager_load(plugin_manager_t *mgr, const char *name) {
     const char *dl_error = dlerror();
     if (dl_error) {
         fprintf(stderr, "Failed to find registration function in %s: %s\n", name, dl_error);
-        dlclose(handle->dl_handle);
-        free(handle);
+        plugin_close(handle);
         return NULL;
     }
     
@@ -171,8 +253,7 @@ plugin_handle_t *plugin_manager_load(plugin_manager_t *mgr, const char *name) {
     handle->plugin = register_fn();
     if (!handle->plugin) {
         fprintf(stderr, "Plugin registration failed for %s\n", name);
-        dlclose(handle->dl_handle);
-        free(handle);
+        plugin_close(handle);
         return NULL;
     }
     
@@ -180,8 +261,15 @@ plugin_handle_t *plugin_manager_load(plugin_manager_t *mgr, const char *name) {
     if (handle->plugin->api_version != NLMON_PLUGIN_API_VERSION) {
         fprintf(stderr, "Plugin %s API version mismatch: expected %d, got %d\n",
                 name, NLMON_PLUGIN_API_VERSION, handle->plugin->api_version);
-        dlclose(handle->dl_handle);
-        free(handle);
+        plugin_close(handle);
+        return NULL;
+    }
+    
+    /* Batch entry point, preferred whenever the plugin has one */
+    handle->batched = handle->plugin->callbacks.on_events != NULL;
+    
+    if (compile_interest(handle) != 0) {
+        plugin_close(handle);
         return NULL;
     }
     
@@ -192,14 +280,48 @@ plugin_handle_t *plugin_manager_load(plugin_manager_t *mgr, const char *name) {
     }
     
     handle->state = PLUGIN_STATE_LOADED;
+    return handle;
+}
+
+/* Unload the library of a plugin no longer in any table and free it */
+void plugin_close(plugin_handle_t *handle) {
+    if (handle->dl_handle) {
+        dlclose(handle->dl_handle);
+    }
+    if (handle->image_fd >= 0) {
+        close(handle->image_fd);
+    }
+    filter_bytecode_free(handle->interest_filter);
+    free(handle);
+}
+
+/* Load a specific plugin */
+plugin_handle_t *plugin_manager_load(plugin_manager_t *mgr, const char *name) {
+    if (!mgr || !name) return NULL;
+    
+    if (mgr->plugin_count >= MAX_PLUGINS) {
+        fprintf(stderr, "Maximum number of plugins reached\n");
+        return NULL;
+    }
+    
+    plugin_handle_t *handle = plugin_open(mgr, name, 0);
+    if (!handle) {
+        return NULL;
+    }
     
     /* Add to plugin list */
     mgr->plugins[mgr->plugin_count++] = handle;
+    if (plugin_dispatch_rebuild(mgr) != 0) {
+        mgr->plugin_count--;
+        plugin_close(handle);
+        return NULL;
+    }
     
-    printf("Loaded plugin: %s v%s - %s\n",
+    printf("Loaded plugin: %s v%s - %s%s\n",
            handle->plugin->name,
            handle->plugin->version,
-           handle->plugin->description);
+           handle->plugin->description,
+           handle->batched ? " (batched)" : "");
     
     return handle;
 }
@@ -225,29 +347,192 @@ int plugin_manager_unload(plugin_manager_t *mgr, const char *name) {
         return -1;
     }
     
+    /* Remove from list, routing no longer reaches the plugin afterwards */
+    for (size_t i = index; i < mgr->plugin_count - 1; i++) {
+        mgr->plugins[i] = mgr->plugins[i + 1];
+    }
+    mgr->plugin_count--;
+    if (plugin_dispatch_rebuild(mgr) != 0) {
+        for (size_t i = mgr->plugin_count; i > index; i--) {
+            mgr->plugins[i] = mgr->plugins[i - 1];
+        }
+        mgr->plugins[index] = handle;
+        mgr->plugin_count++;
+        return -1;
+    }
+    
     /* Call cleanup if initialized */
+    plugin_worker_stop(handle);
+    filter_predicate_unregister_owner(handle);
     if (handle->state == PLUGIN_STATE_INITIALIZED &&
         handle->plugin->callbacks.cleanup) {
         handle->plugin->callbacks.cleanup();
     }
     
     /* Unload shared library */
-    if (handle->dl_handle) {
-        dlclose(handle->dl_handle);
+    plugin_close(handle);
+    
+    printf("Unloaded plugin: %s\n", name);
+    return 0;
+}
+
+/* Add a plugin to the dispatch table */
+static void dispatch_add(struct plugin_dispatch *d, plugin_handle_t *handle, uint64_t bit) {
+    const nlmon_plugin_interest_t *interest = handle->plugin->interest;
+    
+    /* Plugins without an event callback are never dispatched to */
+    if (!handle->batched && !handle->plugin->callbacks.on_event) {
+        return;
     }
     
-    /* Remove from list */
-    free(handle);
+    /* Plugins processing all events ignore their interest too */
+    if (handle->plugin->flags & NLMON_PLUGIN_FLAG_PROCESS_ALL) {
+        interest = NULL;
+    }
     
-    for (size_t i = index; i < mgr->plugin_count - 1; i++) {
-        mgr->plugins[i] = mgr->plugins[i + 1];
+    if (interest && interest->protocols) {
+        for (const int *p = interest->protocols; *p >= 0; p++) {
+            d->by_protocol[*p < PLUGIN_DISPATCH_PROTOCOLS ? *p : PLUGIN_DISPATCH_PROTOCOLS] |= bit;
+        }
+    } else if (interest && interest->genl_families) {
+        d->by_protocol[NETLINK_GENERIC] |= bit;
+    } else {
+        for (size_t p = 0; p <= PLUGIN_DISPATCH_PROTOCOLS; p++) {
+            d->by_protocol[p] |= bit;
+        }
     }
-    mgr->plugin_count--;
     
-    printf("Unloaded plugin: %s\n", name);
+    if (interest && interest->msg_types) {
+        for (const uint16_t *t = interest->msg_types; *t; t++) {
+            if (*t < PLUGIN_DISPATCH_TYPES - 1) {
+                d->by_msg_type[*t] |= bit;
+            } else {
+                d->by_msg_type[PLUGIN_DISPATCH_TYPES - 1] |= bit;
+                d->check_msg_type |= bit;
+            }
+        }
+    } else {
+        for (size_t t = 0; t < PLUGIN_DISPATCH_TYPES; t++) {
+            d->by_msg_type[t] |= bit;
+        }
+    }
+    
+    if (interest && interest->genl_families) {
+        d->check_family |= bit;
+    }
+    if (interest && handle->interest_filter) {
+        d->check_filter |= bit;
+    }
+}
+
+/* Enter a routing section, returning the epoch parity to leave
+ *
+ * The epoch is checked again once counted in, so a rebuild that flipped
+ * it in between either waits for this section or is seen by it.
+ */
+unsigned int plugin_table_enter(plugin_manager_t *mgr) {
+    for (;;) {
+        unsigned int epoch = atomic_load(&mgr->table_epoch);
+        
+        atomic_fetch_add(&mgr->table_readers[epoch & 1], 1);
+        if (atomic_load(&mgr->table_epoch) == epoch) {
+            return epoch & 1;
+        }
+        atomic_fetch_sub(&mgr->table_readers[epoch & 1], 1);
+    }
+}
+
+void plugin_table_exit(plugin_manager_t *mgr, unsigned int parity) {
+    atomic_fetch_sub_explicit(&mgr->table_readers[parity], 1, memory_order_release);
+}
+
+/* Wait until no routing section can still see a table replaced before */
+static void plugin_table_synchronize(plugin_manager_t *mgr) {
+    unsigned int epoch = atomic_fetch_add(&mgr->table_epoch, 1);
+    
+    while (atomic_load(&mgr->table_readers[epoch & 1])) {
+        sched_yield();
+    }
+}
+
+/* Publish a table of the current plugins and their dispatch table */
+int plugin_dispatch_rebuild(plugin_manager_t *mgr) {
+    struct plugin_table *table = calloc(1, sizeof(*table));
+    
+    if (!table) {
+        fprintf(stderr, "Failed to allocate plugin table\n");
+        return -1;
+    }
+    
+    table->count = mgr->plugin_count;
+    for (size_t i = 0; i < mgr->plugin_count; i++) {
+        table->plugins[i] = mgr->plugins[i];
+        dispatch_add(&table->dispatch, mgr->plugins[i], 1ULL << i);
+    }
+    
+    struct plugin_table *old = atomic_exchange_explicit(&mgr->table, table, memory_order_acq_rel);
+    
+    plugin_table_synchronize(mgr);
+    free(old);
     return 0;
 }
 
+/* Check the parts of an interest the dispatch table cannot tell */
+static int interest_matches(plugin_handle_t *handle, struct nlmon_event *event) {
+    const nlmon_plugin_interest_t *interest = handle->plugin->interest;
+    unsigned int type = event->netlink.msg_type;
+    
+    if (interest->msg_types && type >= PLUGIN_DISPATCH_TYPES - 1) {
+        const uint16_t *t = interest->msg_types;
+        
+        while (*t && *t != type) t++;
+        if (!*t) return 0;
+    }
+    
+    if (interest->genl_families && event->netlink.protocol == NETLINK_GENERIC) {
+        const char *const *family = interest->genl_families;
+        
+        while (*family && strncmp(*family, event->netlink.genl_family_name,
+                                  sizeof(event->netlink.genl_family_name)) != 0) {
+            family++;
+        }
+        if (!*family) return 0;
+    }
+    
+    if (handle->interest_filter && !filter_eval(handle->interest_filter, event, NULL)) {
+        return 0;
+    }
+    
+    return 1;
+}
+
+/* Select the plugins interested in an event, bit i for table->plugins[i] */
+uint64_t plugin_dispatch_select(const struct plugin_table *table, struct nlmon_event *event) {
+    const struct plugin_dispatch *d = &table->dispatch;
+    int protocol = event->netlink.protocol;
+    unsigned int type = event->netlink.msg_type;
+    uint64_t mask, check;
+    
+    mask = d->by_protocol[protocol >= 0 && protocol < PLUGIN_DISPATCH_PROTOCOLS ?
+                          protocol : PLUGIN_DISPATCH_PROTOCOLS];
+    mask &= d->by_msg_type[type < PLUGIN_DISPATCH_TYPES - 1 ? type : PLUGIN_DISPATCH_TYPES - 1];
+    
+    /* Exact checks, only for the plugins that need one for this event */
+    check = d->check_filter;
+    if (type >= PLUGIN_DISPATCH_TYPES - 1) check |= d->check_msg_type;
+    if (protocol == NETLINK_GENERIC) check |= d->check_family;
+    
+    for (check &= mask; check; check &= check - 1) {
+        size_t i = (size_t)__builtin_ctzll(check);
+        
+        if (!interest_matches(table->plugins[i], event)) {
+            mask &= ~(1ULL << i);
+        }
+    }
+    
+    return mask;
+}
+
 /* Find plugin by name */
 plugin_handle_t *find_plugin(plugin_manager_t *mgr, const char *name) {
     for (size_t i = 0; i < mgr->plugin_count; i++) {
@@ -289,6 +574,7 @@ int plugin_manager_get_info(plugin_manager_t *mgr, const char *name, plugin_info
     plugin_handle_t *handle = find_plugin(mgr, name);
     if (!handle) return -1;
     
+    memset(info, 0, sizeof(*info));
     strncpy(info->name, handle->name, sizeof(info->name) - 1);
     strncpy(info->path, handle->path, sizeof(info->path) - 1);
     info->state = handle->state;
@@ -301,9 +587,80 @@ int plugin_manager_get_info(plugin_manager_t *mgr, const char *name, plugin_info
         strncpy(info->description, handle->plugin->description, sizeof(info->description) - 1);
     }
     
+    plugin_worker_info(handle, info);
+    
     return 0;
 }
 
+/* Format a table of plugin statistics */
+size_t plugin_manager_format_stats(plugin_manager_t *mgr, char *buf, size_t len) {
+    static const char *state_names[] = {
+        "unloaded", "loaded", "running", "error", "disabled"
+    };
+    size_t used = 0;
+    int n;
+    
+    if (!mgr || !buf || len == 0) return 0;
+    buf[0] = '\0';
+    
+    n = snprintf(buf, len, "%-20s %-9s %11s %11s %9s %9s %6s %9s %9s %9s\n",
+                 "Plugin", "State", "Events", "Queue", "Dropped", "Sampled",
+                 "Rate", "p50(us)", "p99(us)", "Budget");
+    if (n < 0 || (size_t)n >= len) return len - 1;
+    used = n;
+    
+    for (size_t i = 0; i < mgr->plugin_count; i++) {
+        plugin_info_t info;
+        const char *state;
+        
+        if (plugin_manager_get_info(mgr, mgr->plugins[i]->name, &info) != 0) continue;
+        
+        state = info.state <= PLUGIN_STATE_DISABLED ? state_names[info.state] : "?";
+        if (info.suspended) state = "suspended";
+        
+        if (info.isolated) {
+            n = snprintf(buf + used, len - used,
+                         "%-20.20s %-9s %11llu %5zu/%-5zu %9llu %9llu   1/%-3u %9.1f %9.1f %9u\n",
+                         info.name, state, (unsigned long long)info.events_processed,
+                         info.queue_depth, info.queue_capacity,
+                         (unsigned long long)info.events_dropped,
+                         (unsigned long long)info.events_sampled, info.sample_rate,
+                         info.latency_p50_us, info.latency_p99_us, info.latency_budget_us);
+        } else {
+            n = snprintf(buf + used, len - used, "%-20.20s %-9s %11llu %11s\n",
+                         info.name, state, (unsigned long long)info.events_processed, "inline");
+        }
+        if (n < 0 || (size_t)n >= len - used) return len - 1;
+        used += n;
+    }
+    
+    return used;
+}
+
+/* Stats bus collector, the first STATS_BUS_MAX_PLUGINS plugins */
+void plugin_manager_collect_stats(struct nlmon_stats_snapshot *snapshot, void *ctx) {
+    plugin_manager_t *mgr = ctx;
+    
+    if (!mgr) return;
+    
+    for (size_t i = 0; i < mgr->plugin_count && snapshot->num_plugins < STATS_BUS_MAX_PLUGINS; i++) {
+        struct stats_plugin *plugin = &snapshot->plugins[snapshot->num_plugins];
+        plugin_info_t info;
+        
+        if (plugin_manager_get_info(mgr, mgr->plugins[i]->name, &info) != 0) continue;
+        
+        snprintf(plugin->name, sizeof(plugin->name), "%s", info.name);
+        plugin->events_processed = info.events_processed;
+        plugin->events_dropped = info.events_dropped;
+        plugin->budget_violations = info.budget_violations;
+        plugin->queue_depth = info.queue_depth;
+        plugin->latency_p99_us = info.latency_p99_us;
+        plugin->suspended = info.suspended;
+        snapshot->num_plugins++;
+    }
+    snapshot->have |= STATS_HAVE_PLUGINS;
+}
+
 /* List all plugins */
 int plugin_manager_list(plugin_manager_t *mgr, plugin_info_t **list, size_t *count) {
     if (!mgr || !list || !count) return -1;
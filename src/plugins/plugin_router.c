@@ -1,4 +1,5 @@
 #include "plugin_internal.h"
+#include "event_processor.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -44,8 +45,28 @@ static int should_process_event(plugin_handle_t *handle, struct nlmon_event *eve
     return result;
 }
 
-/* Process event with timeout protection */
-static int process_event_with_timeout(plugin_handle_t *handle, struct nlmon_event *event) {
+/* Call the plugin's batch entry point if events is set, else on_event */
+static int invoke_plugin(plugin_handle_t *handle, struct nlmon_event *event,
+                         const struct nlmon_event *const *events, size_t count) {
+    if (events) {
+        return handle->plugin->callbacks.on_events(events, count);
+    }
+    return handle->plugin->callbacks.on_event(event);
+}
+
+/* Count a failed call, disabling the plugin after too many in a row */
+static void plugin_failed(plugin_handle_t *handle) {
+    handle->error_count++;
+
+    if (handle->error_count >= MAX_CONSECUTIVE_ERRORS) {
+        fprintf(stderr, "Plugin %s disabled due to excessive errors\n", handle->name);
+        handle->state = PLUGIN_STATE_DISABLED;
+    }
+}
+
+/* Process event or batch with timeout protection */
+static int process_event_with_timeout(plugin_handle_t *handle, struct nlmon_event *event,
+                                      const struct nlmon_event *const *events, size_t count) {
     struct sigaction sa, old_sa;
     int ret = 0;
     
@@ -58,7 +79,7 @@ static int process_event_with_timeout(plugin_handle_t *handle, struct nlmon_even
     if (sigaction(SIGALRM, &sa, &old_sa) < 0) {
         fprintf(stderr, "Failed to set up timeout handler: %s\n", strerror(errno));
         /* Continue without timeout protection */
-        return handle->plugin->callbacks.on_event(event);
+        return invoke_plugin(handle, event, events, count);
     }
     
     timeout_occurred = 0;
@@ -69,14 +90,9 @@ static int process_event_with_timeout(plugin_handle_t *handle, struct nlmon_even
         alarm(0);  /* Cancel alarm */
         sigaction(SIGALRM, &old_sa, NULL);  /* Restore old handler */
         
-        fprintf(stderr, "Plugin %s timed out processing event\n", handle->name);
-        handle->error_count++;
-        
-        /* Disable plugin if too many errors */
-        if (handle->error_count >= MAX_CONSECUTIVE_ERRORS) {
-            fprintf(stderr, "Plugin %s disabled due to excessive errors\n", handle->name);
-            handle->state = PLUGIN_STATE_DISABLED;
-        }
+        fprintf(stderr, "Plugin %s timed out processing %s\n", handle->name,
+                events ? "event batch" : "event");
+        plugin_failed(handle);
 
         return -1;
     }
@@ -85,7 +101,7 @@ static int process_event_with_timeout(plugin_handle_t *handle, struct nlmon_even
     alarm(PLUGIN_TIMEOUT_SEC);
 
     /* Call plugin event handler */
-    ret = handle->plugin->callbacks.on_event(event);
+    ret = invoke_plugin(handle, event, events, count);
 
     /* Cancel alarm */
     alarm(0);
@@ -96,51 +112,85 @@ static int process_event_with_timeout(plugin_handle_t *handle, struct nlmon_even
     return ret;
 }
 
-/* Route event to all plugins */
+/* Hand an event or a batch to a plugin */
+static int dispatch_to_plugin(plugin_handle_t *handle, struct nlmon_event *event,
+                              const struct nlmon_event *const *events, size_t count) {
+    if (handle->plugin->flags & NLMON_PLUGIN_FLAG_ASYNC) {
+        /* TODO: Queue event for async processing */
+        return invoke_plugin(handle, event, events, count);
+    }
+
+    /* Synchronous processing with timeout */
+    return process_event_with_timeout(handle, event, events, count);
+}
+
+/* Check if a plugin takes events at all */
+static int accepts_events(plugin_handle_t *handle) {
+    /* Skip if not initialized or disabled */
+    if (handle->state != PLUGIN_STATE_INITIALIZED) return 0;
+
+    return handle->batched || handle->plugin->callbacks.on_event != NULL;
+}
+
+/* Queue an event for an isolated plugin, sharing it on first use */
+static int submit_to_worker(plugin_handle_t *handle, struct nlmon_event *event,
+                            struct nlmon_event **ref) {
+    if (!*ref) {
+        *ref = nlmon_event_share(event);
+        if (!*ref) return 0;
+    }
+    return plugin_worker_submit(handle, *ref);
+}
+
+/* Route event to all interested plugins
+ *
+ * Only the plugins the dispatch table selects for the event are looked
+ * at, see plugin_dispatch_select(). Isolated plugins only get a reference queued to their worker, so the
+ * event is copied at most once however many of them there are. Routing
+ * runs inside a section of the plugin table it started with, so plugins
+ * can be loaded, unloaded and swapped meanwhile without pausing it.
+ */
 int plugin_manager_route_event(plugin_manager_t *mgr, struct nlmon_event *event) {
     if (!mgr || !event) return -1;
     
+    struct nlmon_event *ref = NULL;
+    unsigned int parity = plugin_table_enter(mgr);
+    const struct plugin_table *table = atomic_load_explicit(&mgr->table, memory_order_acquire);
+    uint64_t interested = table ? plugin_dispatch_select(table, event) : 0;
     int processed = 0;
     int filtered = 0;
     
-    for (size_t i = 0; i < mgr->plugin_count; i++) {
-        plugin_handle_t *handle = mgr->plugins[i];
+    for (; interested; interested &= interested - 1) {
+        plugin_handle_t *handle = table->plugins[__builtin_ctzll(interested)];
         
-        /* Skip if not initialized or disabled */
-        if (handle->state != PLUGIN_STATE_INITIALIZED) {
+        if (!accepts_events(handle)) {
             continue;
         }
         
-        /* Skip if no event handler */
-        if (!handle->plugin->callbacks.on_event) {
+        /* Check if plugin should process this event */
+        if (!should_process_event(handle, event)) {
             continue;
         }
         
-        /* Check if plugin should process this event */
-        if (!should_process_event(handle, event)) {
+        if (handle->worker) {
+            processed += submit_to_worker(handle, event, &ref);
             continue;
         }
         
-        /* Process event with error handling */
+        /* Process event with error handling, as a batch of one if preferred */
         int ret;
         
-        if (handle->plugin->flags & NLMON_PLUGIN_FLAG_ASYNC) {
-            /* TODO: Queue event for async processing */
-            ret = handle->plugin->callbacks.on_event(event);
+        if (handle->batched) {
+            const struct nlmon_event *view = event;
+            ret = dispatch_to_plugin(handle, NULL, &view, 1);
+            if (ret > 0) ret = 0;  /* Batches cannot stop routing */
         } else {
-            /* Synchronous processing with timeout */
-            ret = process_event_with_timeout(handle, event);
+            ret = dispatch_to_plugin(handle, event, NULL, 0);
         }
         
         if (ret < 0) {
             /* Error occurred */
-            handle->error_count++;
-            
-            /* Disable plugin if too many consecutive errors */
-            if (handle->error_count >= MAX_CONSECUTIVE_ERRORS) {
-                fprintf(stderr, "Plugin %s disabled due to excessive errors\n", handle->name);
-                handle->state = PLUGIN_STATE_DISABLED;
-            }
+            plugin_failed(handle);
         } else if (ret > 0) {
             /* Plugin filtered the event - stop processing */
             filtered = 1;
@@ -158,9 +208,115 @@ int plugin_manager_route_event(plugin_manager_t *mgr, struct nlmon_event *event)
         }
     }
     
+    plugin_table_exit(mgr, parity);
+    if (ref) nlmon_event_put(ref);
+    
     return filtered ? -1 : processed;
 }
 
+/* Route a batch of events to all interested plugins
+ *
+ * Each plugin is looked at only for the events the dispatch table
+ * selects it for, and not at all if there are none. Isolated plugins get references queued to their worker. Inline
+ * batched plugins get one on_events call per chunk of up to
+ * PLUGIN_BATCH_MAX events, with the pointers of the events their filter
+ * accepts; nothing is copied. Other inline plugins see the events one by
+ * one, and an event one of them filters by returning > 0 is not routed
+ * to later plugins, as with plugin_manager_route_event().
+ */
+int plugin_manager_route_events(plugin_manager_t *mgr, struct nlmon_event **events,
+                                size_t count) {
+    if (!mgr || (!events && count)) return -1;
+
+    unsigned int parity = plugin_table_enter(mgr);
+    const struct plugin_table *table = atomic_load_explicit(&mgr->table, memory_order_acquire);
+    int delivered = 0;
+
+    for (size_t base = 0; table && base < count; base += PLUGIN_BATCH_MAX) {
+        size_t n = count - base < PLUGIN_BATCH_MAX ? count - base : PLUGIN_BATCH_MAX;
+        struct nlmon_event **chunk = events + base;
+        unsigned char consumed[PLUGIN_BATCH_MAX];
+        struct nlmon_event *refs[PLUGIN_BATCH_MAX];
+        uint64_t interested[PLUGIN_BATCH_MAX];
+        uint64_t any = 0;
+
+        memset(consumed, 0, n);
+        memset(refs, 0, n * sizeof(*refs));
+
+        for (size_t j = 0; j < n; j++) {
+            interested[j] = plugin_dispatch_select(table, chunk[j]);
+            any |= interested[j];
+        }
+
+        for (; any; any &= any - 1) {
+            size_t i = (size_t)__builtin_ctzll(any);
+            plugin_handle_t *handle = table->plugins[i];
+            uint64_t bit = 1ULL << i;
+
+            if (!accepts_events(handle)) continue;
+
+            if (handle->worker) {
+                for (size_t j = 0; j < n && handle->state == PLUGIN_STATE_INITIALIZED; j++) {
+                    if (!(interested[j] & bit) || consumed[j] ||
+                        !should_process_event(handle, chunk[j])) continue;
+                    delivered += submit_to_worker(handle, chunk[j], &refs[j]);
+                }
+                continue;
+            }
+
+            if (handle->batched) {
+                const struct nlmon_event *view[PLUGIN_BATCH_MAX];
+                size_t m = 0;
+
+                for (size_t j = 0; j < n; j++) {
+                    if ((interested[j] & bit) && !consumed[j] &&
+                        should_process_event(handle, chunk[j])) {
+                        view[m++] = chunk[j];
+                    }
+                }
+                if (m == 0) continue;
+
+                if (dispatch_to_plugin(handle, NULL, view, m) < 0) {
+                    plugin_failed(handle);
+                    continue;
+                }
+
+                handle->events_processed += m;
+                handle->batches_processed++;
+                handle->error_count = 0;
+                delivered += m;
+                continue;
+            }
+
+            for (size_t j = 0; j < n && handle->state == PLUGIN_STATE_INITIALIZED; j++) {
+                if (!(interested[j] & bit) || consumed[j] ||
+                    !should_process_event(handle, chunk[j])) continue;
+
+                int ret = dispatch_to_plugin(handle, chunk[j], NULL, 0);
+
+                if (ret < 0) {
+                    plugin_failed(handle);
+                    continue;
+                }
+
+                /* Plugin filtered the event - later plugins do not see it */
+                if (ret > 0) consumed[j] = 1;
+
+                handle->events_processed++;
+                handle->error_count = 0;
+                delivered++;
+            }
+        }
+
+        for (size_t j = 0; j < n; j++) {
+            if (refs[j]) nlmon_event_put(refs[j]);
+        }
+    }
+
+    plugin_table_exit(mgr, parity);
+    return delivered;
+}
+
 /* Invoke plugin command */
 int plugin_manager_invoke_command(plugin_manager_t *mgr, const char *plugin_name,
                                   const char *cmd, const char *args,
@@ -0,0 +1,384 @@
+#define _GNU_SOURCE
+#include "plugin_internal.h"
+#include "event_processor.h"
+#include "ring_buffer.h"
+#include "hdr_histogram.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define MAX_CONSECUTIVE_ERRORS 10
+
+/* Latency budget enforcement */
+#define BUDGET_STRIKES      8       /* Calls over budget in a row before acting */
+#define BUDGET_RECOVERY     256     /* Calls within budget before easing off */
+#define SAMPLE_RATE_MAX     64      /* Fewest events kept while sampling, 1 in N */
+#define SUSPEND_MIN_MS      1000
+#define SUSPEND_MAX_MS      60000
+
+/* Worker of one plugin
+ *
+ * Routing threads only queue event references and read the atomics; the
+ * worker thread is the only one calling into the plugin, so a slow
+ * plugin just falls behind on its own queue. The worker measures every
+ * call against the budget: after BUDGET_STRIKES slow calls in a row it
+ * halves the share of events the plugin gets, and once sampling is at
+ * its limit it suspends the plugin, for twice as long each time.
+ */
+struct plugin_worker {
+    plugin_handle_t *handle;
+    struct ring_buffer *queue;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    atomic_bool sleeping;
+    atomic_bool stop;
+    atomic_bool drain;              /* Deliver what is queued before stopping */
+    atomic_bool failed;             /* Too many errors, disable on next submit */
+    uint32_t budget_us;
+
+    /* Budget state, written by the worker */
+    atomic_uint sample_rate;
+    atomic_uint_fast64_t sample_counter;
+    _Atomic int64_t suspended_until; /* Monotonic ms, 0 when not suspended */
+    unsigned int strikes;
+    unsigned int good_calls;
+    unsigned int suspend_ms;
+    int errors;
+
+    /* Statistics */
+    atomic_uint_fast64_t processed;
+    atomic_uint_fast64_t dropped;
+    atomic_uint_fast64_t sampled;
+    atomic_uint_fast64_t violations;
+    struct hdr_histogram *latency;  /* Microseconds per event */
+};
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Whether the plugin is resting after exceeding its budget */
+static bool suspended(struct plugin_worker *w) {
+    int64_t until = atomic_load(&w->suspended_until);
+
+    return until && now_ms() < until;
+}
+
+/* Tighten or ease the budget state after a call */
+static void account_call(struct plugin_worker *w, size_t count, uint64_t elapsed_ns) {
+    double per_event_us = (double)elapsed_ns / 1000.0 / (double)count;
+    unsigned int rate = atomic_load(&w->sample_rate);
+
+    hdr_histogram_record(w->latency, per_event_us);
+
+    if (per_event_us <= w->budget_us) {
+        w->strikes = 0;
+
+        /* Easing off: give the plugin more events again */
+        if (rate > 1 && ++w->good_calls >= BUDGET_RECOVERY) {
+            w->good_calls = 0;
+            atomic_store(&w->sample_rate, rate / 2);
+            if (rate / 2 == 1) w->suspend_ms = SUSPEND_MIN_MS;
+        }
+        return;
+    }
+
+    atomic_fetch_add(&w->violations, 1);
+    w->good_calls = 0;
+    if (++w->strikes < BUDGET_STRIKES) return;
+    w->strikes = 0;
+
+    if (rate < SAMPLE_RATE_MAX) {
+        atomic_store(&w->sample_rate, rate * 2);
+        fprintf(stderr, "Plugin %s over its %u us budget, sampling 1 in %u events\n",
+                w->handle->name, w->budget_us, rate * 2);
+        return;
+    }
+
+    /* Sampling did not help, let it rest */
+    atomic_store(&w->suspended_until, now_ms() + w->suspend_ms);
+    fprintf(stderr, "Plugin %s over its %u us budget, suspended for %u ms\n",
+            w->handle->name, w->budget_us, w->suspend_ms);
+    w->suspend_ms = w->suspend_ms * 2 > SUSPEND_MAX_MS ? SUSPEND_MAX_MS : w->suspend_ms * 2;
+}
+
+/* Count the result of a call */
+static void account_result(struct plugin_worker *w, int ret, size_t count) {
+    if (ret < 0) {
+        if (++w->errors >= MAX_CONSECUTIVE_ERRORS) {
+            atomic_store(&w->failed, true);
+        }
+        return;
+    }
+
+    w->errors = 0;
+    atomic_fetch_add(&w->processed, count);
+}
+
+/* Deliver dequeued events to the plugin and drop the references */
+static void deliver(struct plugin_worker *w, struct nlmon_event **events, size_t count) {
+    nlmon_plugin_callbacks_t *cb = &w->handle->plugin->callbacks;
+
+    /* Events queued before a suspension are dropped too, rather than
+     * running them and suspending the plugin again straight away */
+    if (suspended(w)) {
+        atomic_fetch_add(&w->dropped, count);
+    } else if (!atomic_load(&w->failed)) {
+        if (w->handle->batched) {
+            uint64_t start = now_ns();
+            int ret = cb->on_events((const struct nlmon_event *const *)events, count);
+
+            account_call(w, count, now_ns() - start);
+            account_result(w, ret, count);
+        } else {
+            for (size_t i = 0; i < count && !atomic_load(&w->failed); i++) {
+                uint64_t start;
+                int ret;
+
+                if (suspended(w)) {
+                    atomic_fetch_add(&w->dropped, count - i);
+                    break;
+                }
+
+                start = now_ns();
+                ret = cb->on_event(events[i]);
+
+                account_call(w, 1, now_ns() - start);
+                account_result(w, ret, 1);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        nlmon_event_put(events[i]);
+    }
+}
+
+static void *worker_main(void *arg) {
+    struct plugin_worker *w = arg;
+    void *items[PLUGIN_BATCH_MAX];
+
+    while (!atomic_load(&w->stop)) {
+        size_t n = ring_buffer_dequeue_bulk(w->queue, items, PLUGIN_BATCH_MAX);
+
+        if (n > 0) {
+            deliver(w, (struct nlmon_event **)items, n);
+            continue;
+        }
+
+        /* Park until a submit signals; the recheck after announcing it
+         * pairs with the submit's check of sleeping after its enqueue */
+        pthread_mutex_lock(&w->lock);
+        atomic_store(&w->sleeping, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (ring_buffer_is_empty(w->queue) && !atomic_load(&w->stop)) {
+            struct timespec deadline;
+
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 100 * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&w->cond, &w->lock, &deadline);
+        }
+        atomic_store(&w->sleeping, false);
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    /* Whatever is still queued is delivered only if draining */
+    size_t n;
+    while ((n = ring_buffer_dequeue_bulk(w->queue, items, PLUGIN_BATCH_MAX)) > 0) {
+        if (atomic_load(&w->drain)) {
+            deliver(w, (struct nlmon_event **)items, n);
+            continue;
+        }
+        for (size_t i = 0; i < n; i++) {
+            nlmon_event_put(items[i]);
+        }
+    }
+
+    return NULL;
+}
+
+/* Start the worker of an initialized plugin */
+int plugin_worker_start(plugin_handle_t *handle) {
+    struct plugin_worker *w;
+    nlmon_plugin_t *plugin;
+    char name[16];
+
+    if (!handle || !handle->plugin) return -1;
+    if (handle->worker) return 0;
+
+    plugin = handle->plugin;
+    if (plugin->flags & NLMON_PLUGIN_FLAG_INLINE) return 0;
+    if (!handle->batched && !plugin->callbacks.on_event) return 0;
+
+    w = calloc(1, sizeof(*w));
+    if (!w) return -1;
+
+    w->handle = handle;
+    w->budget_us = plugin->latency_budget_us ? plugin->latency_budget_us : PLUGIN_DEFAULT_BUDGET_US;
+    w->suspend_ms = SUSPEND_MIN_MS;
+    atomic_init(&w->sample_rate, 1);
+
+    w->queue = ring_buffer_create_mpmc(plugin->queue_size ? plugin->queue_size : PLUGIN_DEFAULT_QUEUE);
+    if (!w->queue) goto err_free;
+
+    w->latency = hdr_histogram_create(HDR_HISTOGRAM_DEFAULT_SCHEMA);
+    if (!w->latency) goto err_queue;
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+        fprintf(stderr, "Plugin %s: failed to start worker\n", handle->name);
+        goto err_sync;
+    }
+
+    snprintf(name, sizeof(name), "plug-%.10s", handle->name);
+    pthread_setname_np(w->thread, name);
+
+    handle->worker = w;
+    return 0;
+
+err_sync:
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    hdr_histogram_destroy(w->latency);
+err_queue:
+    ring_buffer_destroy(w->queue);
+err_free:
+    free(w);
+    return -1;
+}
+
+/* Stop the worker, before the plugin is cleaned up */
+void plugin_worker_stop(plugin_handle_t *handle) {
+    struct plugin_worker *w;
+
+    if (!handle || !handle->worker) return;
+
+    w = handle->worker;
+    handle->worker = NULL;
+
+    pthread_mutex_lock(&w->lock);
+    atomic_store(&w->stop, true);
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+
+    handle->events_processed += atomic_load(&w->processed);
+
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    hdr_histogram_destroy(w->latency);
+    ring_buffer_destroy(w->queue);
+    free(w);
+}
+
+/* Stop the worker once it has delivered the events queued so far
+ *
+ * Only for a plugin routing no longer reaches, nothing else is queued
+ * meanwhile.
+ */
+void plugin_worker_drain(plugin_handle_t *handle) {
+    if (!handle || !handle->worker) return;
+
+    atomic_store(&handle->worker->drain, true);
+    plugin_worker_stop(handle);
+}
+
+/* Queue a reference to a refcounted event for the plugin
+ *
+ * Returns 1 if queued, 0 if sampled away, dropped or the plugin was
+ * disabled. Never waits for the worker.
+ */
+int plugin_worker_submit(plugin_handle_t *handle, struct nlmon_event *event) {
+    struct plugin_worker *w = handle->worker;
+    struct nlmon_event *ref;
+    unsigned int rate;
+    int64_t until;
+
+    if (atomic_load(&w->failed)) {
+        fprintf(stderr, "Plugin %s disabled due to excessive errors\n", handle->name);
+        handle->error_count += MAX_CONSECUTIVE_ERRORS;
+        handle->state = PLUGIN_STATE_DISABLED;
+        return 0;
+    }
+
+    until = atomic_load_explicit(&w->suspended_until, memory_order_relaxed);
+    if (until) {
+        if (now_ms() < until) {
+            atomic_fetch_add_explicit(&w->dropped, 1, memory_order_relaxed);
+            return 0;
+        }
+        atomic_store(&w->suspended_until, 0);
+    }
+
+    rate = atomic_load_explicit(&w->sample_rate, memory_order_relaxed);
+    if (rate > 1 &&
+        atomic_fetch_add_explicit(&w->sample_counter, 1, memory_order_relaxed) % rate != 0) {
+        atomic_fetch_add_explicit(&w->sampled, 1, memory_order_relaxed);
+        return 0;
+    }
+
+    ref = nlmon_event_share(event);
+    if (!ref || !ring_buffer_enqueue(w->queue, ref)) {
+        if (ref) nlmon_event_put(ref);
+        atomic_fetch_add_explicit(&w->dropped, 1, memory_order_relaxed);
+        return 0;
+    }
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&w->sleeping)) {
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    return 1;
+}
+
+/* Fill in the worker part of the plugin info */
+void plugin_worker_info(plugin_handle_t *handle, plugin_info_t *info) {
+    struct plugin_worker *w = handle->worker;
+    int64_t until;
+
+    if (!w) return;
+
+    until = atomic_load(&w->suspended_until);
+
+    info->isolated = 1;
+    info->queue_depth = ring_buffer_size(w->queue);
+    info->queue_capacity = ring_buffer_capacity(w->queue);
+    info->events_processed += atomic_load(&w->processed);
+    info->events_dropped = atomic_load(&w->dropped);
+    info->events_sampled = atomic_load(&w->sampled);
+    info->budget_violations = atomic_load(&w->violations);
+    info->latency_budget_us = w->budget_us;
+    info->sample_rate = atomic_load(&w->sample_rate);
+    info->suspended = until && now_ms() < until;
+
+    if (hdr_histogram_count(w->latency) > 0) {
+        info->latency_mean_us = hdr_histogram_sum(w->latency) / hdr_histogram_count(w->latency);
+        info->latency_p50_us = hdr_histogram_quantile(w->latency, 0.5);
+        info->latency_p99_us = hdr_histogram_quantile(w->latency, 0.99);
+        info->latency_max_us = hdr_histogram_max(w->latency);
+    }
+}
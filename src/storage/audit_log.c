@@ -3,18 +3,42 @@
  * Implements tamper-evident audit logging using SHA-256 hash chaining.
  * Each log entry includes a hash of the previous entry, making tampering
  * detectable.
+ *
+ * Entries are formatted and chained as they are written, but reach the
+ * file in batches, with one flush (and fdatasync with sync_writes) per
+ * batch. Every checkpoint_interval entries a checkpoint line records the
+ * Merkle root of the hashes of the entries since the previous one. The
+ * checkpoints split the file into segments that are verified in parallel,
+ * and let a range of entries be verified without reading the whole file.
+ *
+ * With an I/O service the batches are written through a second
+ * descriptor, opened without O_APPEND, at the offsets the chain has
+ * accounted for them, since writes in flight may complete out of order.
+ *
+ * Line format:
+ *   [TIMESTAMP] [SEQ] [PREV_HASH] [SEVERITY] text
+ *   [TIMESTAMP] [SEQ] [PREV_HASH] [C] CHECKPOINT first=SEQ count=N root=HASH
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <time.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <openssl/sha.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include "audit_log.h"
+#include "io_service.h"
 #include "event_processor.h"
 
 /* Suppress OpenSSL 3.0 deprecation warnings for SHA256 functions */
@@ -25,38 +49,92 @@
 #define HASH_SIZE 32
 #define HASH_HEX_SIZE (HASH_SIZE * 2 + 1)
 
+/* Longest line the verifier accepts */
+#define MAX_LINE_SIZE 4096
+
+/* Parallel verification limits */
+#define VERIFY_MAX_THREADS 8
+#define VERIFY_MIN_CHUNK (1024 * 1024)
+
+/* Marks checkpoint lines, in place of the severity */
+#define CHECKPOINT_TAG "] [C] CHECKPOINT "
+
+/* One hash-chained log file */
+struct audit_file {
+	FILE *fp;
+	char *path;
+	int fd;                     /* Written by the I/O service, -1 until used */
+	
+	/* Current hash chain */
+	unsigned char prev_hash[HASH_SIZE];
+	uint64_t sequence;
+	uint64_t size;
+	
+	/* Lines chained but not yet written */
+	char *batch;
+	size_t batch_len;
+	size_t batch_alloc;
+	size_t batch_entries;
+	
+	/* Hashes of the entries since the last checkpoint */
+	unsigned char (*leaves)[HASH_SIZE];
+	uint64_t first_leaf;
+	size_t leaf_count;
+};
+
 /* Audit log structure */
 struct audit_log {
-	FILE *log_file;
-	FILE *security_file;
-	char *log_path;
-	char *security_log_path;
+	struct audit_file main;
+	struct audit_file security;
+	bool has_security;
 	size_t max_file_size;
 	size_t max_rotations;
+	size_t batch_size;
+	size_t checkpoint_interval;
 	bool sync_writes;
-	
-	/* Current hash chain */
-	unsigned char prev_hash[HASH_SIZE];
+	struct io_service *io;
+	atomic_bool io_failed;
 	
 	/* Statistics */
 	uint64_t total_entries;
 	uint64_t security_entries;
-	uint64_t file_size;
 	uint64_t rotations;
-	uint64_t sequence;
 	
 	pthread_mutex_t lock;
 };
 
+/* Parsed log line */
+struct audit_line {
+	uint64_t sequence;
+	unsigned char prev_hash[HASH_SIZE];
+	bool checkpoint;
+	uint64_t first;
+	uint64_t count;
+	unsigned char root[HASH_SIZE];
+};
+
 /* Convert hash to hex string */
 static void hash_to_hex(const unsigned char *hash, char *hex)
 {
+	static const char digits[] = "0123456789abcdef";
+	
 	for (int i = 0; i < HASH_SIZE; i++) {
-		sprintf(hex + (i * 2), "%02x", hash[i]);
+		hex[i * 2] = digits[hash[i] >> 4];
+		hex[i * 2 + 1] = digits[hash[i] & 0x0f];
 	}
 	hex[HASH_HEX_SIZE - 1] = '\0';
 }
 
+/* Value of a lowercase hex digit, -1 if it is none */
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
 /* Convert hex string to hash */
 static bool hex_to_hash(const char *hex, unsigned char *hash)
 {
@@ -64,8 +142,12 @@ static bool hex_to_hash(const char *hex, unsigned char *hash)
 		return false;
 	
 	for (int i = 0; i < HASH_SIZE; i++) {
-		if (sscanf(hex + (i * 2), "%2hhx", &hash[i]) != 1)
+		int hi = hex_digit(hex[i * 2]);
+		int lo = hex_digit(hex[i * 2 + 1]);
+		
+		if (hi < 0 || lo < 0)
 			return false;
+		hash[i] = (hi << 4) | lo;
 	}
 	
 	return true;
@@ -80,6 +162,36 @@ static void compute_hash(const void *data, size_t len, unsigned char *hash)
 	SHA256_Final(hash, &ctx);
 }
 
+/* Compute Merkle root of leaf hashes, overwriting them */
+static void compute_merkle_root(unsigned char (*nodes)[HASH_SIZE], size_t count,
+                                unsigned char *root)
+{
+	static const unsigned char node_prefix = 0x01;
+	SHA256_CTX ctx;
+	
+	if (count == 0) {
+		memset(root, 0, HASH_SIZE);
+		return;
+	}
+	
+	/* Hash pairs level by level, an odd node moves up unchanged */
+	while (count > 1) {
+		size_t pairs = count / 2;
+		
+		for (size_t i = 0; i < pairs; i++) {
+			SHA256_Init(&ctx);
+			SHA256_Update(&ctx, &node_prefix, 1);
+			SHA256_Update(&ctx, nodes[i * 2], HASH_SIZE * 2);
+			SHA256_Final(nodes[i], &ctx);
+		}
+		if (count & 1)
+			memcpy(nodes[pairs], nodes[count - 1], HASH_SIZE);
+		count = pairs + (count & 1);
+	}
+	
+	memcpy(root, nodes[0], HASH_SIZE);
+}
+
 #pragma GCC diagnostic pop
 
 /* Get file size */
@@ -96,95 +208,278 @@ static size_t get_file_size(FILE *fp)
 	return st.st_size;
 }
 
-/* Read last hash from log file */
-static bool read_last_hash(FILE *fp, unsigned char *hash)
+/* Parse a log line, @len bytes without terminating NUL */
+static bool parse_line(const char *text, size_t len, struct audit_line *line)
 {
-	char line[2048];
+	char buf[MAX_LINE_SIZE];
 	char hash_hex[HASH_HEX_SIZE];
-	bool found = false;
+	char root_hex[HASH_HEX_SIZE];
 	
-	if (!fp)
+	if (len >= sizeof(buf))
+		return false;
+	memcpy(buf, text, len);
+	buf[len] = '\0';
+	
+	if (sscanf(buf, "%*s [%" SCNu64 "] [%64[0-9a-f]]", &line->sequence, hash_hex) != 2 ||
+	    !hex_to_hash(hash_hex, line->prev_hash))
 		return false;
 	
-	/* Seek to end and read backwards to find last hash */
+	line->checkpoint = strstr(buf, CHECKPOINT_TAG) != NULL;
+	if (line->checkpoint) {
+		if (sscanf(strstr(buf, CHECKPOINT_TAG) + strlen(CHECKPOINT_TAG),
+		           "first=%" SCNu64 " count=%" SCNu64 " root=%64[0-9a-f]",
+		           &line->first, &line->count, root_hex) != 3 ||
+		    !hex_to_hash(root_hex, line->root))
+			return false;
+	}
+	
+	return true;
+}
+
+/* Continue the chain of an existing log file after its last line */
+static void read_last_line(FILE *fp, unsigned char *hash, uint64_t *sequence)
+{
+	char line[MAX_LINE_SIZE];
+	struct audit_line parsed;
+	long pos;
+	
+	memset(hash, 0, HASH_SIZE);
+	*sequence = 0;
+	
+	if (!fp || fseek(fp, 0, SEEK_END) != 0)
+		return;
+	
+	/* Find the start of the last line, skipping its newline */
+	pos = ftell(fp) - 1;
+	while (pos > 0) {
+		fseek(fp, pos - 1, SEEK_SET);
+		if (fgetc(fp) == '\n')
+			break;
+		pos--;
+	}
+	if (pos < 0)
+		return;
+	
+	fseek(fp, pos, SEEK_SET);
+	if (fgets(line, sizeof(line), fp) &&
+	    parse_line(line, strlen(line), &parsed)) {
+		compute_hash(line, strlen(line), hash);
+		*sequence = parsed.sequence + 1;
+	}
+	
 	fseek(fp, 0, SEEK_END);
-	long pos = ftell(fp);
-	
-	/* Read last line */
-	if (pos > 0) {
-		while (pos > 0) {
-			fseek(fp, --pos, SEEK_SET);
-			if (fgetc(fp) == '\n') {
-				if (fgets(line, sizeof(line), fp)) {
-					/* Parse hash from line format: [TIMESTAMP] [SEQ] [HASH] ... */
-					if (sscanf(line, "%*s %*s %64s", hash_hex) == 1) {
-						if (hex_to_hash(hash_hex, hash)) {
-							found = true;
-							break;
-						}
-					}
-				}
-				break;
-			}
-		}
-	} else {
-		/* File is empty or very small, try reading from start */
-		rewind(fp);
-		if (fgets(line, sizeof(line), fp)) {
-			if (sscanf(line, "%*s %*s %64s", hash_hex) == 1) {
-				hex_to_hash(hash_hex, hash);
-			}
+}
+
+/* Open log file and continue its chain */
+static bool audit_file_open(struct audit_file *file, const char *path,
+                            size_t checkpoint_interval)
+{
+	file->fd = -1;
+	file->path = strdup(path);
+	if (!file->path)
+		return false;
+	
+	if (checkpoint_interval > 0) {
+		file->leaves = malloc(checkpoint_interval * sizeof(*file->leaves));
+		if (!file->leaves) {
+			free(file->path);
+			return false;
 		}
 	}
 	
-	/* If no hash found, use zero hash */
-	if (!found)
-		memset(hash, 0, HASH_SIZE);
+	file->fp = fopen(path, "a+");
+	if (!file->fp) {
+		free(file->leaves);
+		free(file->path);
+		return false;
+	}
+	
+	read_last_line(file->fp, file->prev_hash, &file->sequence);
+	file->size = get_file_size(file->fp);
+	
+	return true;
+}
+
+static void audit_file_close(struct audit_file *file)
+{
+	if (file->fd >= 0)
+		close(file->fd);
+	if (file->fp)
+		fclose(file->fp);
+	
+	free(file->batch);
+	free(file->leaves);
+	free(file->path);
+}
+
+static void io_done(void *ctx, int result)
+{
+	struct audit_log *log = ctx;
+	
+	if (result < 0)
+		atomic_store(&log->io_failed, true);
+}
+
+/* Wait for the I/O service, false if one of the writes failed */
+static bool io_settle(struct audit_log *log)
+{
+	if (!log->io)
+		return true;
+	
+	io_service_wait(log->io);
+	return !atomic_exchange(&log->io_failed, false);
+}
+
+/* Hand the batch to the I/O service, it ends at the accounted file size */
+static bool submit_batch(struct audit_log *log, struct audit_file *file)
+{
+	if (file->fd < 0)
+		file->fd = open(file->path, O_WRONLY | O_CLOEXEC);
+	if (file->fd < 0)
+		return false;
+	
+	return io_service_write_data(log->io, file->fd, file->size - file->batch_len,
+	                             file->batch, file->batch_len,
+	                             log->sync_writes ? IO_WRITE_DATASYNC : 0,
+	                             io_done, log);
+}
+
+/* Write the batched lines to the file */
+static bool flush_batch(struct audit_log *log, struct audit_file *file)
+{
+	bool result = true;
+	
+	if (file->batch_len == 0)
+		return true;
+	
+	if (log->io) {
+		result = file->fp && submit_batch(log, file);
+	} else if (!file->fp || fwrite(file->batch, 1, file->batch_len, file->fp) != file->batch_len)
+		result = false;
+	
+	if (result && log->sync_writes && !log->io) {
+		if (fflush(file->fp) != 0 || fdatasync(fileno(file->fp)) != 0)
+			result = false;
+	}
+	
+	file->batch_len = 0;
+	file->batch_entries = 0;
+	
+	return result;
+}
+
+/* Format a line, chain it and add it to the batch */
+static bool append_line(struct audit_file *file, const char *tag,
+                        const char *text, unsigned char *line_hash)
+{
+	char timestamp[32];
+	char prev_hash_hex[HASH_HEX_SIZE];
+	char log_line[MAX_LINE_SIZE];
+	time_t now;
+	struct tm tm_info;
+	int len;
+	
+	/* Get timestamp */
+	time(&now);
+	gmtime_r(&now, &tm_info);
+	strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &tm_info);
+	
+	/* Convert previous hash to hex */
+	hash_to_hex(file->prev_hash, prev_hash_hex);
+	
+	/* Build log line, a truncated one still ends with a newline */
+	len = snprintf(log_line, sizeof(log_line), "[%s] [%" PRIu64 "] [%s] [%s] %s\n",
+	               timestamp, file->sequence, prev_hash_hex, tag, text);
+	if (len < 0)
+		return false;
+	if ((size_t)len >= sizeof(log_line)) {
+		len = sizeof(log_line) - 1;
+		log_line[len - 1] = '\n';
+	}
+	
+	if (file->batch_len + len > file->batch_alloc) {
+		size_t alloc = file->batch_alloc ? file->batch_alloc * 2 : sizeof(log_line) * 4;
+		char *batch;
+		
+		while (alloc < file->batch_len + len)
+			alloc *= 2;
+		batch = realloc(file->batch, alloc);
+		if (!batch)
+			return false;
+		file->batch = batch;
+		file->batch_alloc = alloc;
+	}
+	
+	/* Compute hash of this entry */
+	compute_hash(log_line, len, line_hash);
+	
+	memcpy(file->batch + file->batch_len, log_line, len);
+	file->batch_len += len;
+	
+	/* Update state */
+	memcpy(file->prev_hash, line_hash, HASH_SIZE);
+	file->sequence++;
+	file->size += len;
 	
 	return true;
 }
 
+/* Close the current segment with the Merkle root of its entries */
+static bool write_checkpoint(struct audit_file *file)
+{
+	unsigned char root[HASH_SIZE];
+	unsigned char line_hash[HASH_SIZE];
+	char root_hex[HASH_HEX_SIZE];
+	char text[256];
+	
+	if (file->leaf_count == 0)
+		return true;
+	
+	compute_merkle_root(file->leaves, file->leaf_count, root);
+	hash_to_hex(root, root_hex);
+	snprintf(text, sizeof(text), "CHECKPOINT first=%" PRIu64 " count=%zu root=%s",
+	         file->first_leaf, file->leaf_count, root_hex);
+	
+	file->leaf_count = 0;
+	
+	return append_line(file, "C", text, line_hash);
+}
+
 /* Rotate log file */
-static bool rotate_log_file(struct audit_log *log, const char *path)
+static bool rotate_log_file(struct audit_log *log, struct audit_file *file)
 {
 	char old_path[512];
 	char new_path[512];
 	
-	/* Close current file */
-	FILE *fp = NULL;
-	if (strcmp(path, log->log_path) == 0) {
-		fp = log->log_file;
-		log->log_file = NULL;
-	} else if (log->security_log_path && strcmp(path, log->security_log_path) == 0) {
-		fp = log->security_file;
-		log->security_file = NULL;
-	}
+	/* Finish the current file */
+	write_checkpoint(file);
+	flush_batch(log, file);
+	io_settle(log);
 	
-	if (fp)
-		fclose(fp);
+	if (file->fd >= 0)
+		close(file->fd);
+	file->fd = -1;
+	if (file->fp)
+		fclose(file->fp);
+	file->fp = NULL;
 	
 	/* Rotate existing files */
 	for (int i = log->max_rotations - 1; i > 0; i--) {
-		snprintf(old_path, sizeof(old_path), "%s.%d", path, i - 1);
-		snprintf(new_path, sizeof(new_path), "%s.%d", path, i);
+		snprintf(old_path, sizeof(old_path), "%s.%d", file->path, i - 1);
+		snprintf(new_path, sizeof(new_path), "%s.%d", file->path, i);
 		rename(old_path, new_path);
 	}
 	
 	/* Rotate current file to .0 */
-	snprintf(new_path, sizeof(new_path), "%s.0", path);
-	rename(path, new_path);
+	snprintf(new_path, sizeof(new_path), "%s.0", file->path);
+	rename(file->path, new_path);
 	
 	/* Open new file */
-	fp = fopen(path, "a");
-	if (!fp)
+	file->fp = fopen(file->path, "a+");
+	file->size = 0;
+	if (!file->fp)
 		return false;
 	
-	if (strcmp(path, log->log_path) == 0) {
-		log->log_file = fp;
-	} else if (log->security_log_path && strcmp(path, log->security_log_path) == 0) {
-		log->security_file = fp;
-	}
-	
 	log->rotations++;
 	
 	return true;
@@ -201,60 +496,40 @@ struct audit_log *audit_log_open(struct audit_log_config *config)
 	if (!log)
 		return NULL;
 	
-	log->log_path = strdup(config->log_path);
-	if (!log->log_path) {
-		free(log);
-		return NULL;
-	}
-	
-	if (config->security_log_path) {
-		log->security_log_path = strdup(config->security_log_path);
-		if (!log->security_log_path) {
-			free(log->log_path);
-			free(log);
-			return NULL;
-		}
-	}
-	
 	log->max_file_size = config->max_file_size > 0 ? config->max_file_size : 100 * 1024 * 1024;
 	log->max_rotations = config->max_rotations > 0 ? config->max_rotations : 10;
+	log->batch_size = config->batch_size > 0 ? config->batch_size : 1;
+	log->checkpoint_interval = config->checkpoint_interval;
 	log->sync_writes = config->sync_writes;
+	log->io = config->io_service;
+	atomic_init(&log->io_failed, false);
 	
 	/* Open log file */
-	log->log_file = fopen(log->log_path, "a");
-	if (!log->log_file) {
-		free(log->security_log_path);
-		free(log->log_path);
+	if (!audit_file_open(&log->main, config->log_path, log->checkpoint_interval)) {
 		free(log);
 		return NULL;
 	}
 	
 	/* Open security log if separate */
-	if (log->security_log_path) {
-		log->security_file = fopen(log->security_log_path, "a");
-		if (!log->security_file) {
-			fclose(log->log_file);
-			free(log->security_log_path);
-			free(log->log_path);
+	if (config->security_log_path) {
+		if (!audit_file_open(&log->security, config->security_log_path,
+		                     log->checkpoint_interval)) {
+			audit_file_close(&log->main);
 			free(log);
 			return NULL;
 		}
+		log->has_security = true;
 	}
 	
-	/* Read last hash from log */
-	read_last_hash(log->log_file, log->prev_hash);
-	
 	/* Verify log integrity if requested */
 	if (config->verify_on_open) {
 		size_t error_line;
-		if (!audit_log_verify(log->log_path, &error_line)) {
+		if (!audit_log_verify(log->main.path, &error_line)) {
 			fprintf(stderr, "Warning: Audit log integrity check failed at line %zu\n",
 			        error_line);
 		}
 	}
 	
-	log->file_size = get_file_size(log->log_file);
-	
 	pthread_mutex_init(&log->lock, NULL);
 	
 	return log;
@@ -267,71 +542,61 @@ void audit_log_close(struct audit_log *log)
 	
 	pthread_mutex_lock(&log->lock);
 	
-	if (log->log_file)
-		fclose(log->log_file);
+	/* Checkpoint and write what is left */
+	write_checkpoint(&log->main);
+	flush_batch(log, &log->main);
+	if (log->has_security) {
+		write_checkpoint(&log->security);
+		flush_batch(log, &log->security);
+	}
+	io_settle(log);
 	
-	if (log->security_file)
-		fclose(log->security_file);
+	audit_file_close(&log->main);
+	if (log->has_security)
+		audit_file_close(&log->security);
 	
 	pthread_mutex_unlock(&log->lock);
 	pthread_mutex_destroy(&log->lock);
 	
-	free(log->security_log_path);
-	free(log->log_path);
 	free(log);
 }
 
 /* Internal write function */
-static bool write_entry(struct audit_log *log, FILE *fp,
+static bool write_entry(struct audit_log *log, struct audit_file *file,
                        enum audit_severity severity,
                        const char *entry_text)
 {
-	char timestamp[32];
-	char prev_hash_hex[HASH_HEX_SIZE];
 	unsigned char curr_hash[HASH_SIZE];
-	char log_line[4096];
-	time_t now;
-	struct tm *tm_info;
+	char tag[16];
+	uint64_t sequence;
+	bool result = true;
 	
-	if (!log || !fp || !entry_text)
+	if (!log || !file->fp || !entry_text)
 		return false;
 	
-	/* Get timestamp */
-	time(&now);
-	tm_info = gmtime(&now);
-	strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", tm_info);
-	
-	/* Convert previous hash to hex */
-	hash_to_hex(log->prev_hash, prev_hash_hex);
-	
-	/* Build log line */
-	snprintf(log_line, sizeof(log_line), "[%s] [%lu] [%s] [%d] %s\n",
-	        timestamp, log->sequence, prev_hash_hex, severity, entry_text);
-	
-	/* Compute hash of this entry */
-	compute_hash(log_line, strlen(log_line), curr_hash);
-	
-	/* Write to file */
-	if (fputs(log_line, fp) == EOF)
+	sequence = file->sequence;
+	snprintf(tag, sizeof(tag), "%d", severity);
+	if (!append_line(file, tag, entry_text, curr_hash))
 		return false;
+	file->batch_entries++;
+	
+	/* Collect the entry for the next checkpoint */
+	if (file->leaves) {
+		if (file->leaf_count == 0)
+			file->first_leaf = sequence;
+		memcpy(file->leaves[file->leaf_count++], curr_hash, HASH_SIZE);
+		if (file->leaf_count >= log->checkpoint_interval)
+			write_checkpoint(file);
+	}
 	
-	if (log->sync_writes)
-		fflush(fp);
-	
-	/* Update state */
-	memcpy(log->prev_hash, curr_hash, HASH_SIZE);
-	log->sequence++;
-	log->file_size += strlen(log_line);
+	if (file->batch_entries >= log->batch_size)
+		result = flush_batch(log, file);
 	
 	/* Check if rotation needed */
-	if (log->file_size >= log->max_file_size) {
-		const char *path = (fp == log->log_file) ? log->log_path : log->security_log_path;
-		if (path)
-			rotate_log_file(log, path);
-		log->file_size = 0;
-	}
+	if (file->size >= log->max_file_size)
+		rotate_log_file(log, file);
 	
-	return true;
+	return result;
 }
 
 bool audit_log_write(struct audit_log *log,
@@ -354,15 +619,15 @@ bool audit_log_write(struct audit_log *log,
 	pthread_mutex_lock(&log->lock);
 	
 	/* Write to main log */
-	result = write_entry(log, log->log_file, severity, entry);
+	result = write_entry(log, &log->main, severity, entry);
 	
 	if (result) {
 		log->total_entries++;
 		
 		/* Write to security log if this is a security event */
 		if (severity == AUDIT_SECURITY || severity == AUDIT_CRITICAL) {
-			FILE *sec_fp = log->security_file ? log->security_file : log->log_file;
-			write_entry(log, sec_fp, severity, entry);
+			struct audit_file *sec_file = log->has_security ? &log->security : &log->main;
+			write_entry(log, sec_file, severity, entry);
 			log->security_entries++;
 		}
 	}
@@ -389,14 +654,14 @@ bool audit_log_write_message(struct audit_log *log,
 	
 	pthread_mutex_lock(&log->lock);
 	
-	result = write_entry(log, log->log_file, severity, message);
+	result = write_entry(log, &log->main, severity, message);
 	
 	if (result) {
 		log->total_entries++;
 		
 		if (severity == AUDIT_SECURITY || severity == AUDIT_CRITICAL) {
-			FILE *sec_fp = log->security_file ? log->security_file : log->log_file;
-			write_entry(log, sec_fp, severity, message);
+			struct audit_file *sec_file = log->has_security ? &log->security : &log->main;
+			write_entry(log, sec_file, severity, message);
 			log->security_entries++;
 		}
 	}
@@ -406,52 +671,372 @@ bool audit_log_write_message(struct audit_log *log,
 	return result;
 }
 
+bool audit_log_flush(struct audit_log *log)
+{
+	bool result;
+	
+	if (!log)
+		return false;
+	
+	pthread_mutex_lock(&log->lock);
+	
+	result = flush_batch(log, &log->main);
+	if (log->has_security && !flush_batch(log, &log->security))
+		result = false;
+	
+	if (!io_settle(log))
+		result = false;
+	
+	/* Without sync_writes the batch still has to leave stdio */
+	if (!log->sync_writes && !log->io) {
+		if (log->main.fp && fflush(log->main.fp) != 0)
+			result = false;
+		if (log->has_security && log->security.fp && fflush(log->security.fp) != 0)
+			result = false;
+	}
+	
+	pthread_mutex_unlock(&log->lock);
+	
+	return result;
+}
+
+/* Mapped log file being verified */
+struct verify_map {
+	const char *data;
+	size_t size;
+};
+
+/* Part of a log file verified by one thread */
+struct verify_chunk {
+	const struct verify_map *map;
+	const char *start;
+	const char *end;
+	size_t lines;               /* Lines checked */
+	size_t error_line;          /* Line in the chunk of the first error, 0 if none */
+	uint64_t error_seq;         /* Its sequence number, if it could be parsed */
+};
+
+static bool verify_map_open(const char *path, struct verify_map *map)
+{
+	struct stat st;
+	int fd;
+	
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+	
+	map->size = st.st_size;
+	map->data = NULL;
+	if (map->size > 0) {
+		void *data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		
+		if (data == MAP_FAILED) {
+			close(fd);
+			return false;
+		}
+		madvise(data, map->size, MADV_SEQUENTIAL);
+		map->data = data;
+	}
+	
+	close(fd);
+	return true;
+}
+
+static void verify_map_close(struct verify_map *map)
+{
+	if (map->data)
+		munmap((void *)map->data, map->size);
+}
+
+/* End of the line starting at @line */
+static const char *line_end(const struct verify_map *map, const char *line)
+{
+	const char *end = map->data + map->size;
+	const char *nl = memchr(line, '\n', end - line);
+	
+	return nl ? nl + 1 : end;
+}
+
+/* Start of the line before the one starting at @line */
+static const char *line_before(const struct verify_map *map, const char *line)
+{
+	const char *p = line - 1;
+	
+	while (p > map->data && p[-1] != '\n')
+		p--;
+	
+	return p;
+}
+
+/* Start of the first line at or after @p */
+static const char *line_at(const struct verify_map *map, const char *p)
+{
+	if (p == map->data || p[-1] == '\n')
+		return p;
+	
+	return line_end(map, p);
+}
+
+static bool is_checkpoint(const char *line, const char *end)
+{
+	return memmem(line, end - line, CHECKPOINT_TAG, strlen(CHECKPOINT_TAG)) != NULL;
+}
+
+/* Check the chain links and checkpoint roots of a chunk */
+static void *verify_chunk_run(void *arg)
+{
+	struct verify_chunk *chunk = arg;
+	const struct verify_map *map = chunk->map;
+	unsigned char (*leaves)[HASH_SIZE] = NULL;
+	uint64_t *leaf_seqs = NULL;
+	size_t leaf_count = 0;
+	size_t leaf_alloc = 0;
+	unsigned char prev_hash[HASH_SIZE];
+	struct audit_line line;
+	
+	/* The first line links to the one before the chunk */
+	memset(prev_hash, 0, HASH_SIZE);
+	if (chunk->start > map->data) {
+		const char *prev = line_before(map, chunk->start);
+		compute_hash(prev, chunk->start - prev, prev_hash);
+	}
+	
+	for (const char *p = chunk->start; p < chunk->end; ) {
+		const char *next = line_end(map, p);
+		bool valid;
+		
+		chunk->lines++;
+		
+		valid = parse_line(p, next - p, &line) &&
+		        memcmp(line.prev_hash, prev_hash, HASH_SIZE) == 0;
+		
+		/* Compute hash of this line for next iteration */
+		compute_hash(p, next - p, prev_hash);
+		
+		if (valid && line.checkpoint) {
+			/* The root covers the last entries, the ones before it
+			 * were left without a checkpoint by a crash */
+			unsigned char root[HASH_SIZE];
+			
+			valid = line.count > 0 && line.count <= leaf_count &&
+			        leaf_seqs[leaf_count - line.count] == line.first;
+			if (valid) {
+				compute_merkle_root(leaves + (leaf_count - line.count), line.count, root);
+				valid = memcmp(root, line.root, HASH_SIZE) == 0;
+			}
+			leaf_count = 0;
+		} else if (valid) {
+			if (leaf_count == leaf_alloc) {
+				size_t alloc = leaf_alloc ? leaf_alloc * 2 : 256;
+				void *new_leaves = realloc(leaves, alloc * sizeof(*leaves));
+				void *new_seqs = new_leaves ? realloc(leaf_seqs, alloc * sizeof(*leaf_seqs)) : NULL;
+				
+				if (new_leaves)
+					leaves = new_leaves;
+				if (new_seqs)
+					leaf_seqs = new_seqs;
+				if (!new_leaves || !new_seqs)
+					valid = false;
+				else
+					leaf_alloc = alloc;
+			}
+			if (valid) {
+				memcpy(leaves[leaf_count], prev_hash, HASH_SIZE);
+				leaf_seqs[leaf_count++] = line.sequence;
+			}
+		}
+		
+		if (!valid) {
+			chunk->error_line = chunk->lines;
+			chunk->error_seq = line.sequence;
+			break;
+		}
+		
+		p = next;
+	}
+	
+	free(leaf_seqs);
+	free(leaves);
+	
+	return NULL;
+}
+
+/* Start of the first segment at or after @p */
+static const char *segment_at(const struct verify_map *map, const char *p)
+{
+	const char *end = map->data + map->size;
+	
+	for (p = line_at(map, p); p < end; ) {
+		const char *next = line_end(map, p);
+		
+		if (is_checkpoint(p, next))
+			return next;
+		p = next;
+	}
+	
+	return end;
+}
+
 bool audit_log_verify(const char *log_path, size_t *error_line)
 {
-	FILE *fp;
-	char line[4096];
-	unsigned char expected_hash[HASH_SIZE];
-	char hash_hex[HASH_HEX_SIZE];
-	size_t line_num = 0;
+	struct verify_chunk chunks[VERIFY_MAX_THREADS];
+	pthread_t threads[VERIFY_MAX_THREADS];
+	bool started[VERIFY_MAX_THREADS] = {false};
+	struct verify_map map;
+	size_t nchunks;
+	size_t line_offset = 0;
+	long cpus;
 	bool valid = true;
 	
 	if (!log_path)
 		return false;
 	
-	fp = fopen(log_path, "r");
-	if (!fp)
+	if (!verify_map_open(log_path, &map))
 		return false;
 	
-	/* Initialize with zero hash */
-	memset(expected_hash, 0, HASH_SIZE);
+	/* One chunk per CPU, split at checkpoints */
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nchunks = map.size / VERIFY_MIN_CHUNK;
+	if (cpus > 0 && nchunks > (size_t)cpus)
+		nchunks = cpus;
+	if (nchunks > VERIFY_MAX_THREADS)
+		nchunks = VERIFY_MAX_THREADS;
+	if (nchunks == 0)
+		nchunks = 1;
+	
+	for (size_t i = 0; i < nchunks; i++) {
+		memset(&chunks[i], 0, sizeof(chunks[i]));
+		chunks[i].map = &map;
+		chunks[i].start = i == 0 ? map.data :
+		                  segment_at(&map, map.data + map.size / nchunks * i);
+		if (i > 0 && chunks[i].start < chunks[i - 1].start)
+			chunks[i].start = chunks[i - 1].start;
+		if (i > 0)
+			chunks[i - 1].end = chunks[i].start;
+	}
+	chunks[nchunks - 1].end = map.data + map.size;
+	
+	for (size_t i = 1; i < nchunks; i++)
+		started[i] = pthread_create(&threads[i], NULL, verify_chunk_run, &chunks[i]) == 0;
+	verify_chunk_run(&chunks[0]);
+	for (size_t i = 1; i < nchunks; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			verify_chunk_run(&chunks[i]);
+	}
 	
-	while (fgets(line, sizeof(line), fp)) {
-		line_num++;
-		
-		/* Parse hash from line */
-		if (sscanf(line, "%*s %*s %64s", hash_hex) != 1) {
+	/* Report the first error in file order */
+	for (size_t i = 0; i < nchunks; i++) {
+		if (chunks[i].error_line) {
 			valid = false;
 			if (error_line)
-				*error_line = line_num;
+				*error_line = line_offset + chunks[i].error_line;
 			break;
 		}
+		line_offset += chunks[i].lines;
+	}
+	
+	verify_map_close(&map);
+	
+	return valid;
+}
+
+/* Sequence number of the line at @p, false if it cannot be parsed */
+static bool line_sequence(const struct verify_map *map, const char *p, uint64_t *sequence)
+{
+	struct audit_line line;
+	
+	if (!parse_line(p, line_end(map, p) - p, &line))
+		return false;
+	
+	*sequence = line.sequence;
+	return true;
+}
+
+bool audit_log_verify_range(const char *log_path, uint64_t first_seq,
+                            uint64_t last_seq, uint64_t *error_seq)
+{
+	struct verify_chunk chunk = {0};
+	struct verify_map map;
+	const char *end;
+	const char *p;
+	size_t lo = 0;
+	size_t hi;
+	uint64_t sequence;
+	bool valid = true;
+	
+	if (!log_path || first_seq > last_seq)
+		return false;
+	
+	if (!verify_map_open(log_path, &map))
+		return false;
+	
+	end = map.data + map.size;
+	
+	/* Binary search for the first line at or after first_seq */
+	hi = map.size;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
 		
-		/* Verify hash matches expected */
-		char expected_hex[HASH_HEX_SIZE];
-		hash_to_hex(expected_hash, expected_hex);
-		
-		if (strcmp(hash_hex, expected_hex) != 0) {
+		p = line_at(&map, map.data + mid);
+		if (p == end) {
+			hi = mid;
+			continue;
+		}
+		if (!line_sequence(&map, p, &sequence)) {
 			valid = false;
-			if (error_line)
-				*error_line = line_num;
 			break;
 		}
+		if (sequence >= first_seq)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	
+	if (valid) {
+		chunk.map = &map;
 		
-		/* Compute hash of this line for next iteration */
-		compute_hash(line, strlen(line), expected_hash);
+		/* Back to the start of its segment */
+		p = line_at(&map, map.data + lo);
+		while (p > map.data) {
+			const char *prev = line_before(&map, p);
+			
+			if (is_checkpoint(prev, p))
+				break;
+			p = prev;
+		}
+		chunk.start = p;
+		
+		/* Forward to the checkpoint closing the segment of last_seq */
+		for (p = line_at(&map, map.data + lo); p < end; ) {
+			const char *next = line_end(&map, p);
+			
+			if (is_checkpoint(p, next) &&
+			    line_sequence(&map, p, &sequence) && sequence > last_seq) {
+				p = next;
+				break;
+			}
+			p = next;
+		}
+		chunk.end = p;
+		
+		verify_chunk_run(&chunk);
+		if (chunk.error_line) {
+			valid = false;
+			if (error_seq)
+				*error_seq = chunk.error_seq;
+		}
+	} else if (error_seq) {
+		*error_seq = first_seq;
 	}
 	
-	fclose(fp);
+	verify_map_close(&map);
 	
 	return valid;
 }
@@ -464,7 +1049,7 @@ bool audit_log_rotate(struct audit_log *log)
 		return false;
 	
 	pthread_mutex_lock(&log->lock);
-	result = rotate_log_file(log, log->log_path);
+	result = rotate_log_file(log, &log->main);
 	pthread_mutex_unlock(&log->lock);
 	
 	return result;
@@ -486,7 +1071,7 @@ bool audit_log_get_stats(struct audit_log *log,
 	if (security_entries)
 		*security_entries = log->security_entries;
 	if (file_size)
-		*file_size = log->file_size;
+		*file_size = log->main.size;
 	if (rotations)
 		*rotations = log->rotations;
 	
@@ -2,6 +2,21 @@
  *
  * Implements time-based and size-based retention policies with
  * automatic cleanup and configurable enforcement schedules.
+ *
+ * The cleanup thread also runs database maintenance: incremental vacuum
+ * in bounded page steps and passive WAL checkpoints. While the async
+ * writer's queue is deeper than busy_queue_depth, maintenance backs off
+ * exponentially and cleanups wait, up to a limit, so they do not compete
+ * with ingest for the database.
+ *
+ * Stored events are counted into a ring of time slice buckets. A bucket
+ * whose slot is taken by a newer slice folds into the older totals, so
+ * the ring covers the most recent slices and everything before them in
+ * one sum. Size-based retention drops the oldest buckets that cover the
+ * excess with a single delete before the end of the last one, and time-
+ * based retention forgets the buckets its cutoff passed. Counts stay
+ * approximate: a delete's row count settles them, but events stored
+ * while a bucket is recycled can land in the next slice.
  */
 
 #include <stdlib.h>
@@ -9,19 +24,55 @@
 #include <stdio.h>
 #include <time.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <unistd.h>
 #include "retention_policy.h"
 #include "storage_db.h"
 #include "storage_buffer.h"
+#include "storage_log.h"
+#include "thread_affinity.h"
+#include "nlmon_clock.h"
+
+/* Default pages per incremental vacuum step */
+#define DEFAULT_VACUUM_STEP_PAGES 128
+
+/* Time one maintenance run may spend on vacuum steps */
+#define VACUUM_BUDGET_US 50000
+
+/* Maintenance intervals a busy database can defer work by */
+#define MAX_MAINTENANCE_BACKOFF 64
+
+/* Recheck interval of a cleanup deferred by load */
+#define CLEANUP_RETRY_MS 1000
+
+/* Buckets of stored events, and the slice of each without a maximum age */
+#define NUM_BUCKETS 64
+#define DEFAULT_BUCKET_SECONDS 3600
+
+/* Stored events of one time slice */
+struct retention_bucket {
+	_Atomic uint64_t slice;         /* timestamp / bucket_seconds */
+	_Atomic uint64_t events;
+	_Atomic uint64_t bytes;
+};
+
+/* A bucket at a point in time, for picking the ones to drop */
+struct bucket_view {
+	uint64_t slice;
+	uint64_t events;
+	uint64_t bytes;
+};
 
 /* Retention policy structure */
 struct retention_policy {
 	struct retention_policy_config config;
 	struct storage_db *db;
 	struct storage_buffer *buffer;
+	struct storage_log *log;
 	
 	/* Background cleanup thread */
 	pthread_t cleanup_thread;
+	pthread_cond_t wake;            /* Signalled to stop the thread */
 	bool thread_running;
 	bool thread_stop;
 	
@@ -29,14 +80,230 @@ struct retention_policy {
 	struct retention_stats stats;
 	
 	pthread_mutex_t lock;
+	
+	/* Stored events per time slice, see retention_policy_account() */
+	struct retention_bucket buckets[NUM_BUCKETS];
+	uint64_t bucket_seconds;
+	_Atomic uint64_t older_events;  /* Before every bucket, or stored before we started */
+	_Atomic uint64_t older_bytes;
+	pthread_mutex_t buckets_lock;   /* Recycling and forgetting buckets */
+	
+	/* Admission watermark of check_event(), recomputed once a second */
+	_Atomic uint64_t admit_from;
+	_Atomic int64_t admit_at;       /* Second of admit_from, -1 when stale */
+	_Atomic uint64_t size_floor;    /* End of the slices size retention dropped */
+	_Atomic int64_t max_age;        /* config.max_age_seconds outside the lock */
+	_Atomic uint64_t rejected;
 };
 
-/* Get current timestamp in seconds */
-static uint64_t get_current_time(void)
+/* Monotonic time in microseconds */
+static uint64_t get_monotonic_us(void)
 {
 	struct timespec ts;
-	clock_gettime(CLOCK_REALTIME, &ts);
-	return ts.tv_sec;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Whether the async writer has more than @depth events queued */
+static bool database_busy(struct storage_db *db, size_t depth)
+{
+	struct storage_db_writer_stats writer;
+	
+	if (!db || depth == 0)
+		return false;
+	
+	/* Without an async writer there is no queue to watch */
+	if (!storage_db_get_writer_stats(db, &writer))
+		return false;
+	
+	return writer.queue_depth > depth;
+}
+
+/* Record a duration in a last/max/total triple */
+static void record_duration(uint64_t us, uint64_t *last, uint64_t *max, uint64_t *total)
+{
+	*last = us;
+	if (us > *max)
+		*max = us;
+	*total += us;
+}
+
+/* One maintenance run, called without the policy lock, counting into @stats */
+static void run_maintenance(struct storage_db *db, uint32_t step, size_t busy_depth,
+                            struct retention_stats *stats)
+{
+	uint64_t start, begin;
+	int wal_frames, checkpointed;
+	int pages;
+	
+	/* Vacuum steps until the free list is empty, the writer gets busy
+	 * or the budget is spent, releasing the database between steps */
+	begin = get_monotonic_us();
+	do {
+		start = get_monotonic_us();
+		pages = storage_db_incremental_vacuum(db, step);
+		if (pages <= 0)
+			break;
+		
+		stats->vacuum_steps++;
+		stats->vacuum_pages += pages;
+		record_duration(get_monotonic_us() - start, &stats->vacuum_last_us,
+		                &stats->vacuum_max_us, &stats->vacuum_total_us);
+	} while ((uint32_t)pages == step && !database_busy(db, busy_depth) &&
+	         get_monotonic_us() - begin < VACUUM_BUDGET_US);
+	
+	start = get_monotonic_us();
+	if (storage_db_wal_checkpoint(db, &wal_frames, &checkpointed) && wal_frames > 0) {
+		stats->checkpoints++;
+		stats->checkpoint_frames += checkpointed;
+		record_duration(get_monotonic_us() - start, &stats->checkpoint_last_us,
+		                &stats->checkpoint_max_us, &stats->checkpoint_total_us);
+	}
+}
+
+/* Add the counts of one maintenance run to the policy statistics */
+static void add_maintenance_stats(struct retention_stats *stats,
+                                  const struct retention_stats *run)
+{
+	if (run->vacuum_steps) {
+		stats->vacuum_steps += run->vacuum_steps;
+		stats->vacuum_pages += run->vacuum_pages;
+		stats->vacuum_last_us = run->vacuum_last_us;
+		stats->vacuum_total_us += run->vacuum_total_us;
+		if (run->vacuum_max_us > stats->vacuum_max_us)
+			stats->vacuum_max_us = run->vacuum_max_us;
+	}
+	
+	if (run->checkpoints) {
+		stats->checkpoints += run->checkpoints;
+		stats->checkpoint_frames += run->checkpoint_frames;
+		stats->checkpoint_last_us = run->checkpoint_last_us;
+		stats->checkpoint_total_us += run->checkpoint_total_us;
+		if (run->checkpoint_max_us > stats->checkpoint_max_us)
+			stats->checkpoint_max_us = run->checkpoint_max_us;
+	}
+}
+
+/* Bucket width for a configuration */
+static uint64_t bucket_width(const struct retention_policy_config *config)
+{
+	if (config->bucket_seconds > 0)
+		return (uint64_t)config->bucket_seconds;
+	if (config->max_age_seconds > 0)
+		return ((uint64_t)config->max_age_seconds + NUM_BUCKETS - 1) / NUM_BUCKETS;
+	return DEFAULT_BUCKET_SECONDS;
+}
+
+/* Oldest timestamp admitted at @now */
+static uint64_t admit_from(struct retention_policy *policy, int64_t now)
+{
+	int64_t max_age;
+	uint64_t from;
+	
+	if (atomic_load_explicit(&policy->admit_at, memory_order_acquire) == now)
+		return atomic_load_explicit(&policy->admit_from, memory_order_relaxed);
+	
+	from = atomic_load_explicit(&policy->size_floor, memory_order_relaxed);
+	max_age = atomic_load_explicit(&policy->max_age, memory_order_relaxed);
+	if (max_age > 0 && now > max_age && (uint64_t)(now - max_age) > from)
+		from = (uint64_t)(now - max_age);
+	
+	atomic_store_explicit(&policy->admit_from, from, memory_order_relaxed);
+	atomic_store_explicit(&policy->admit_at, now, memory_order_release);
+	return from;
+}
+
+/* Take @n of @events and the matching share of @bytes */
+static void take_share(_Atomic uint64_t *events, _Atomic uint64_t *bytes, uint64_t n)
+{
+	uint64_t have = atomic_load_explicit(events, memory_order_relaxed);
+	uint64_t size = atomic_load_explicit(bytes, memory_order_relaxed);
+	
+	if (n >= have) {
+		atomic_store_explicit(events, 0, memory_order_relaxed);
+		atomic_store_explicit(bytes, 0, memory_order_relaxed);
+		return;
+	}
+	atomic_fetch_sub_explicit(events, n, memory_order_relaxed);
+	atomic_fetch_sub_explicit(bytes, size / have * n, memory_order_relaxed);
+}
+
+/* Drop the accounting of the @deleted events before @cutoff */
+static void forget_before(struct retention_policy *policy, uint64_t cutoff, uint64_t deleted)
+{
+	uint64_t width = policy->bucket_seconds;
+	uint64_t removed = 0, rest;
+	
+	pthread_mutex_lock(&policy->buckets_lock);
+	
+	/* Buckets wholly before the cutoff are gone */
+	for (int i = 0; i < NUM_BUCKETS; i++) {
+		struct retention_bucket *b = &policy->buckets[i];
+		
+		if ((atomic_load_explicit(&b->slice, memory_order_relaxed) + 1) * width > cutoff)
+			continue;
+		removed += atomic_exchange_explicit(&b->events, 0, memory_order_relaxed);
+		atomic_store_explicit(&b->bytes, 0, memory_order_relaxed);
+	}
+	
+	/* The rest of the rows came from the older events, then the bucket
+	 * the cutoff falls in */
+	rest = deleted > removed ? deleted - removed : 0;
+	if (rest) {
+		uint64_t older = atomic_load_explicit(&policy->older_events, memory_order_relaxed);
+		
+		take_share(&policy->older_events, &policy->older_bytes, rest);
+		rest = rest > older ? rest - older : 0;
+	}
+	if (rest) {
+		struct retention_bucket *b = &policy->buckets[(cutoff / width) % NUM_BUCKETS];
+		
+		if (atomic_load_explicit(&b->slice, memory_order_relaxed) == cutoff / width)
+			take_share(&b->events, &b->bytes, rest);
+	}
+	
+	pthread_mutex_unlock(&policy->buckets_lock);
+}
+
+/* Copy the non-empty buckets, oldest first, returning their number and
+ * the totals of all stored events */
+static int view_buckets(struct retention_policy *policy, struct bucket_view *view,
+                        uint64_t *total_events, uint64_t *total_bytes)
+{
+	int n = 0;
+	
+	*total_events = atomic_load_explicit(&policy->older_events, memory_order_relaxed);
+	*total_bytes = atomic_load_explicit(&policy->older_bytes, memory_order_relaxed);
+	
+	for (int i = 0; i < NUM_BUCKETS; i++) {
+		struct retention_bucket *b = &policy->buckets[i];
+		struct bucket_view v;
+		int j;
+		
+		v.events = atomic_load_explicit(&b->events, memory_order_relaxed);
+		if (!v.events)
+			continue;
+		v.slice = atomic_load_explicit(&b->slice, memory_order_relaxed);
+		v.bytes = atomic_load_explicit(&b->bytes, memory_order_relaxed);
+		*total_events += v.events;
+		*total_bytes += v.bytes;
+		
+		for (j = n; j > 0 && view[j - 1].slice > v.slice; j--)
+			view[j] = view[j - 1];
+		view[j] = v;
+		n++;
+	}
+	return n;
+}
+
+/* Events in the accounting */
+static uint64_t accounted_events(struct retention_policy *policy)
+{
+	uint64_t events = atomic_load_explicit(&policy->older_events, memory_order_relaxed);
+	
+	for (int i = 0; i < NUM_BUCKETS; i++)
+		events += atomic_load_explicit(&policy->buckets[i].events, memory_order_relaxed);
+	return events;
 }
 
 /* Enforce time-based retention on database */
@@ -48,76 +315,195 @@ static int enforce_time_retention_db(struct retention_policy *policy)
 	if (!policy->db || policy->config.max_age_seconds == 0)
 		return 0;
 	
-	cutoff_time = get_current_time() - policy->config.max_age_seconds;
+	cutoff_time = (uint64_t)nlmon_clock_seconds() - policy->config.max_age_seconds;
 	
 	deleted = storage_db_delete_before(policy->db, cutoff_time);
+	if (deleted >= 0)
+		forget_before(policy, cutoff_time, (uint64_t)deleted);
 	
 	return deleted;
 }
 
+/* Enforce time-based retention on the segment log */
+static int enforce_time_retention_log(struct retention_policy *policy)
+{
+	if (!policy->log || policy->config.max_age_seconds == 0)
+		return 0;
+	
+	return storage_log_delete_before(policy->log,
+	                                 (uint64_t)nlmon_clock_seconds() - policy->config.max_age_seconds);
+}
+
 /* Enforce size-based retention on database */
 static int enforce_size_retention_db(struct retention_policy *policy)
 {
-	uint64_t total_events;
-	uint64_t db_size;
-	int deleted = 0;
+	struct bucket_view view[NUM_BUCKETS];
+	uint64_t total_events, total_bytes;
+	uint64_t excess_events = 0, excess_bytes = 0;
+	uint64_t events, bytes, cutoff, db_size = 0;
+	int n, i, deleted;
 	
-	if (!policy->db)
+	if (!policy->db || (policy->config.max_events == 0 && policy->config.max_db_size_mb == 0))
 		return 0;
 	
-	/* Get current database stats */
-	if (!storage_db_get_stats(policy->db, &total_events, &db_size, NULL))
-		return -1;
+	n = view_buckets(policy, view, &total_events, &total_bytes);
 	
 	/* Check event count limit */
-	if (policy->config.max_events > 0 && total_events > policy->config.max_events) {
-		size_t to_delete = total_events - policy->config.max_events;
-		
-		/* Delete in batches if configured */
-		if (policy->config.batch_delete_size > 0) {
-			to_delete = (to_delete < policy->config.batch_delete_size) ?
-			           to_delete : policy->config.batch_delete_size;
-		}
-		
-		int result = storage_db_delete_oldest(policy->db, policy->config.max_events);
-		if (result > 0)
-			deleted += result;
-	}
+	if (policy->config.max_events > 0 && total_events > policy->config.max_events)
+		excess_events = total_events - policy->config.max_events;
 	
-	/* Check database size limit */
+	/* Check database size limit, the file's excess as a share of the
+	 * accounted bytes */
 	if (policy->config.max_db_size_mb > 0) {
 		uint64_t max_size = (uint64_t)policy->config.max_db_size_mb * 1024 * 1024;
 		
-		if (db_size > max_size) {
-			/* Delete oldest 10% of events */
-			size_t keep_count = (total_events * 9) / 10;
-			int result = storage_db_delete_oldest(policy->db, keep_count);
-			if (result > 0)
-				deleted += result;
-			
-			/* Vacuum to reclaim space */
-			storage_db_vacuum(policy->db);
-		}
+		if (!storage_db_get_stats(policy->db, NULL, &db_size, NULL))
+			return -1;
+		if (db_size > max_size)
+			excess_bytes = (total_bytes * (db_size - max_size) + db_size - 1) / db_size;
+	}
+	
+	if (!excess_events && !excess_bytes)
+		return 0;
+	
+	events = atomic_load_explicit(&policy->older_events, memory_order_relaxed);
+	bytes = atomic_load_explicit(&policy->older_bytes, memory_order_relaxed);
+	
+	/* Nothing stored since we started: the older events have no times
+	 * to cut at, so the database picks the oldest */
+	if (n == 0) {
+		if (excess_bytes && bytes && events * excess_bytes / bytes > excess_events)
+			excess_events = events * excess_bytes / bytes;
+		deleted = storage_db_delete_oldest(policy->db, total_events > excess_events ?
+		                                   total_events - excess_events : 0);
+		if (deleted < 0)
+			return -1;
+		pthread_mutex_lock(&policy->buckets_lock);
+		take_share(&policy->older_events, &policy->older_bytes, (uint64_t)deleted);
+		pthread_mutex_unlock(&policy->buckets_lock);
+		goto out;
+	}
+	
+	/* Oldest first until the excess is covered: the older events, then
+	 * whole buckets */
+	cutoff = view[0].slice * policy->bucket_seconds;
+	for (i = 0; i < n && (events < excess_events || bytes < excess_bytes); i++) {
+		events += view[i].events;
+		bytes += view[i].bytes;
+		cutoff = (view[i].slice + 1) * policy->bucket_seconds;
+	}
+	
+	deleted = storage_db_delete_before(policy->db, cutoff);
+	if (deleted < 0)
+		return -1;
+	forget_before(policy, cutoff, (uint64_t)deleted);
+	
+	/* Later events of the dropped slices would go next time */
+	if (cutoff > atomic_load_explicit(&policy->size_floor, memory_order_relaxed)) {
+		atomic_store_explicit(&policy->size_floor, cutoff, memory_order_relaxed);
+		atomic_store_explicit(&policy->admit_at, -1, memory_order_release);
 	}
 	
+out:
+	/* Vacuum to reclaim space */
+	if (excess_bytes)
+		storage_db_vacuum(policy->db);
+	
 	return deleted;
 }
 
+/* Current event count from the accounting, size from the file */
+static void update_counts(struct retention_policy *policy, struct retention_stats *stats)
+{
+	uint64_t db_size;
+	
+	if (!policy->db)
+		return;
+	
+	stats->current_event_count = accounted_events(policy);
+	if (storage_db_get_stats(policy->db, NULL, &db_size, NULL))
+		stats->current_db_size_bytes = db_size;
+}
+
+/* Wait on the policy lock until @deadline_us or a stop request */
+static void wait_until(struct retention_policy *policy, uint64_t deadline_us)
+{
+	struct timespec ts;
+	
+	ts.tv_sec = deadline_us / 1000000;
+	ts.tv_nsec = (deadline_us % 1000000) * 1000;
+	
+	while (!policy->thread_stop && get_monotonic_us() < deadline_us) {
+		if (pthread_cond_timedwait(&policy->wake, &policy->lock, &ts) != 0)
+			break;
+	}
+}
+
 /* Cleanup thread function */
 static void *cleanup_thread_func(void *arg)
 {
 	struct retention_policy *policy = arg;
+	uint64_t now = get_monotonic_us();
+	uint64_t next_cleanup = now + (uint64_t)policy->config.cleanup_interval * 1000000;
+	uint64_t cleanup_due = next_cleanup;
+	uint64_t next_maintenance = now;
+	uint64_t backoff = 1;
+	size_t busy_depth;
+	bool busy;
+	
+	pthread_mutex_lock(&policy->lock);
 	
 	while (!policy->thread_stop) {
-		/* Sleep for cleanup interval */
-		sleep(policy->config.cleanup_interval);
+		uint64_t cleanup_us = (uint64_t)policy->config.cleanup_interval * 1000000;
+		uint64_t maintenance_us = (uint64_t)policy->config.maintenance_interval_ms * 1000;
+		uint64_t deadline = next_cleanup;
 		
+		if (maintenance_us && policy->db && next_maintenance < deadline)
+			deadline = next_maintenance;
+		
+		wait_until(policy, deadline);
 		if (policy->thread_stop)
 			break;
 		
-		/* Enforce policy */
-		pthread_mutex_lock(&policy->lock);
+		now = get_monotonic_us();
+		busy_depth = policy->config.busy_queue_depth;
+		busy = database_busy(policy->db, busy_depth);
+		
+		/* Maintenance backs off while the writer is busy, but runs at
+		 * the longest backoff so the WAL and free list stay bounded */
+		if (maintenance_us && policy->db && now >= next_maintenance) {
+			if (busy && backoff < MAX_MAINTENANCE_BACKOFF) {
+				backoff *= 2;
+				policy->stats.maintenance_deferred++;
+			} else {
+				struct retention_stats run = {0};
+				uint32_t step = policy->config.vacuum_step_pages;
+				
+				/* Keep check_event() callers out of the wait */
+				pthread_mutex_unlock(&policy->lock);
+				run_maintenance(policy->db, step, busy_depth, &run);
+				pthread_mutex_lock(&policy->lock);
+				
+				add_maintenance_stats(&policy->stats, &run);
+				if (!busy)
+					backoff = 1;
+			}
+			next_maintenance = now + maintenance_us * backoff;
+		}
+		
+		if (now < next_cleanup)
+			continue;
 		
+		/* A busy database defers cleanups by up to one interval */
+		if (busy && now < cleanup_due + cleanup_us) {
+			policy->stats.cleanups_deferred++;
+			next_cleanup = now + CLEANUP_RETRY_MS * 1000;
+			continue;
+		}
+		next_cleanup = now + cleanup_us;
+		cleanup_due = next_cleanup;
+		
+		/* Enforce policy */
 		int deleted = 0;
 		int result;
 		
@@ -126,6 +512,10 @@ static void *cleanup_thread_func(void *arg)
 		if (result > 0)
 			deleted += result;
 		
+		result = enforce_time_retention_log(policy);
+		if (result > 0)
+			deleted += result;
+		
 		/* Size-based retention */
 		result = enforce_size_retention_db(policy);
 		if (result > 0)
@@ -135,25 +525,35 @@ static void *cleanup_thread_func(void *arg)
 		if (deleted > 0) {
 			policy->stats.total_cleanups++;
 			policy->stats.total_deleted += deleted;
-			policy->stats.last_cleanup_time = get_current_time();
+			policy->stats.last_cleanup_time = (uint64_t)nlmon_clock_seconds();
 			policy->stats.last_deleted_count = deleted;
 		}
 		
 		/* Update current counts */
-		if (policy->db) {
-			uint64_t total_events, db_size;
-			if (storage_db_get_stats(policy->db, &total_events, &db_size, NULL)) {
-				policy->stats.current_event_count = total_events;
-				policy->stats.current_db_size_bytes = db_size;
-			}
-		}
-		
-		pthread_mutex_unlock(&policy->lock);
+		update_counts(policy, &policy->stats);
 	}
 	
+	pthread_mutex_unlock(&policy->lock);
+	
 	return NULL;
 }
 
+/* Condition variable timed against CLOCK_MONOTONIC */
+static bool init_wake_cond(pthread_cond_t *cond)
+{
+	pthread_condattr_t attr;
+	bool ok;
+	
+	if (pthread_condattr_init(&attr) != 0)
+		return false;
+	
+	ok = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0 &&
+	     pthread_cond_init(cond, &attr) == 0;
+	
+	pthread_condattr_destroy(&attr);
+	return ok;
+}
+
 struct retention_policy *retention_policy_create(
 	struct retention_policy_config *config,
 	struct storage_db *db,
@@ -169,6 +569,13 @@ struct retention_policy *retention_policy_create(
 		return NULL;
 	
 	policy->config = *config;
+	if (config->cpus) {
+		policy->config.cpus = strdup(config->cpus);
+		if (!policy->config.cpus) {
+			free(policy);
+			return NULL;
+		}
+	}
 	policy->db = db;
 	policy->buffer = buffer;
 	policy->thread_running = false;
@@ -182,7 +589,33 @@ struct retention_policy *retention_policy_create(
 	if (policy->config.batch_delete_size == 0)
 		policy->config.batch_delete_size = 1000;
 	
+	if (policy->config.vacuum_step_pages == 0)
+		policy->config.vacuum_step_pages = DEFAULT_VACUUM_STEP_PAGES;
+	
+	policy->bucket_seconds = bucket_width(&policy->config);
+	atomic_init(&policy->admit_at, -1);
+	atomic_init(&policy->max_age, (int64_t)policy->config.max_age_seconds);
+	
+	/* Events already stored count as older than every bucket, the one
+	 * time rows are counted */
+	if (db) {
+		uint64_t total_events = 0, db_size = 0;
+		
+		if (storage_db_get_stats(db, &total_events, &db_size, NULL) && total_events) {
+			atomic_init(&policy->older_events, total_events);
+			atomic_init(&policy->older_bytes, db_size);
+		}
+	}
+	
 	pthread_mutex_init(&policy->lock, NULL);
+	pthread_mutex_init(&policy->buckets_lock, NULL);
+	if (!init_wake_cond(&policy->wake)) {
+		pthread_mutex_destroy(&policy->buckets_lock);
+		pthread_mutex_destroy(&policy->lock);
+		free((char *)policy->config.cpus);
+		free(policy);
+		return NULL;
+	}
 	
 	/* Run initial cleanup if configured */
 	if (config->cleanup_on_startup) {
@@ -192,6 +625,16 @@ struct retention_policy *retention_policy_create(
 	return policy;
 }
 
+void retention_policy_set_log(struct retention_policy *policy, struct storage_log *log)
+{
+	if (!policy)
+		return;
+	
+	pthread_mutex_lock(&policy->lock);
+	policy->log = log;
+	pthread_mutex_unlock(&policy->lock);
+}
+
 void retention_policy_destroy(struct retention_policy *policy)
 {
 	if (!policy)
@@ -202,7 +645,10 @@ void retention_policy_destroy(struct retention_policy *policy)
 		retention_policy_stop(policy);
 	}
 	
+	pthread_cond_destroy(&policy->wake);
+	pthread_mutex_destroy(&policy->buckets_lock);
 	pthread_mutex_destroy(&policy->lock);
+	free((char *)policy->config.cpus);
 	free(policy);
 }
 
@@ -225,6 +671,14 @@ int retention_policy_enforce(struct retention_policy *policy)
 		return -1;
 	}
 	
+	result = enforce_time_retention_log(policy);
+	if (result > 0)
+		deleted += result;
+	else if (result < 0) {
+		pthread_mutex_unlock(&policy->lock);
+		return -1;
+	}
+	
 	/* Size-based retention */
 	result = enforce_size_retention_db(policy);
 	if (result > 0)
@@ -238,18 +692,12 @@ int retention_policy_enforce(struct retention_policy *policy)
 	if (deleted > 0) {
 		policy->stats.total_cleanups++;
 		policy->stats.total_deleted += deleted;
-		policy->stats.last_cleanup_time = get_current_time();
+		policy->stats.last_cleanup_time = (uint64_t)nlmon_clock_seconds();
 		policy->stats.last_deleted_count = deleted;
 	}
 	
 	/* Update current counts */
-	if (policy->db) {
-		uint64_t total_events, db_size;
-		if (storage_db_get_stats(policy->db, &total_events, &db_size, NULL)) {
-			policy->stats.current_event_count = total_events;
-			policy->stats.current_db_size_bytes = db_size;
-		}
-	}
+	update_counts(policy, &policy->stats);
 	
 	pthread_mutex_unlock(&policy->lock);
 	
@@ -278,6 +726,8 @@ bool retention_policy_start(struct retention_policy *policy)
 		return false;
 	}
 	
+	thread_affinity_apply(policy->cleanup_thread, policy->config.cpus, -1, "retention");
+	
 	policy->thread_running = true;
 	
 	pthread_mutex_unlock(&policy->lock);
@@ -298,6 +748,7 @@ void retention_policy_stop(struct retention_policy *policy)
 	}
 	
 	policy->thread_stop = true;
+	pthread_cond_signal(&policy->wake);
 	
 	pthread_mutex_unlock(&policy->lock);
 	
@@ -312,24 +763,55 @@ void retention_policy_stop(struct retention_policy *policy)
 bool retention_policy_check_event(struct retention_policy *policy,
                                   uint64_t timestamp)
 {
-	bool should_retain = true;
-	
 	if (!policy)
 		return true;
 	
-	pthread_mutex_lock(&policy->lock);
+	if (timestamp >= admit_from(policy, (int64_t)nlmon_clock_seconds()))
+		return true;
+	
+	atomic_fetch_add_explicit(&policy->rejected, 1, memory_order_relaxed);
+	return false;
+}
+
+void retention_policy_account(struct retention_policy *policy,
+                              uint64_t timestamp, size_t bytes)
+{
+	struct retention_bucket *b;
+	uint64_t slice, held;
 	
-	/* Check time-based retention */
-	if (policy->config.max_age_seconds > 0) {
-		uint64_t cutoff_time = get_current_time() - policy->config.max_age_seconds;
-		if (timestamp < cutoff_time) {
-			should_retain = false;
+	if (!policy)
+		return;
+	
+	slice = timestamp / policy->bucket_seconds;
+	b = &policy->buckets[slice % NUM_BUCKETS];
+	
+	if (atomic_load_explicit(&b->slice, memory_order_acquire) != slice) {
+		pthread_mutex_lock(&policy->buckets_lock);
+		held = atomic_load_explicit(&b->slice, memory_order_relaxed);
+		
+		/* Older than the slot's slice, so older than the ring */
+		if (slice < held) {
+			atomic_fetch_add_explicit(&policy->older_events, 1, memory_order_relaxed);
+			atomic_fetch_add_explicit(&policy->older_bytes, bytes, memory_order_relaxed);
+			pthread_mutex_unlock(&policy->buckets_lock);
+			return;
+		}
+		
+		/* A newer slice takes the slot, its events join the older ones */
+		if (slice > held) {
+			atomic_fetch_add_explicit(&policy->older_events,
+			                          atomic_exchange_explicit(&b->events, 0, memory_order_relaxed),
+			                          memory_order_relaxed);
+			atomic_fetch_add_explicit(&policy->older_bytes,
+			                          atomic_exchange_explicit(&b->bytes, 0, memory_order_relaxed),
+			                          memory_order_relaxed);
+			atomic_store_explicit(&b->slice, slice, memory_order_release);
 		}
+		pthread_mutex_unlock(&policy->buckets_lock);
 	}
 	
-	pthread_mutex_unlock(&policy->lock);
-	
-	return should_retain;
+	atomic_fetch_add_explicit(&b->events, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&b->bytes, bytes, memory_order_relaxed);
 }
 
 bool retention_policy_get_stats(struct retention_policy *policy,
@@ -343,13 +825,9 @@ bool retention_policy_get_stats(struct retention_policy *policy,
 	*stats = policy->stats;
 	
 	/* Update current counts if database available */
-	if (policy->db) {
-		uint64_t total_events, db_size;
-		if (storage_db_get_stats(policy->db, &total_events, &db_size, NULL)) {
-			stats->current_event_count = total_events;
-			stats->current_db_size_bytes = db_size;
-		}
-	}
+	update_counts(policy, stats);
+	stats->admit_from = admit_from(policy, (int64_t)nlmon_clock_seconds());
+	stats->rejected = atomic_load_explicit(&policy->rejected, memory_order_relaxed);
 	
 	pthread_mutex_unlock(&policy->lock);
 	
@@ -365,6 +843,9 @@ bool retention_policy_update_config(struct retention_policy *policy,
 	pthread_mutex_lock(&policy->lock);
 	
 	policy->config = *config;
+	atomic_store_explicit(&policy->max_age, (int64_t)config->max_age_seconds,
+	                      memory_order_relaxed);
+	atomic_store_explicit(&policy->admit_at, -1, memory_order_release);
 	
 	/* Set defaults if not specified */
 	if (policy->config.cleanup_interval == 0)
@@ -373,6 +854,9 @@ bool retention_policy_update_config(struct retention_policy *policy,
 	if (policy->config.batch_delete_size == 0)
 		policy->config.batch_delete_size = 1000;
 	
+	if (policy->config.vacuum_step_pages == 0)
+		policy->config.vacuum_step_pages = DEFAULT_VACUUM_STEP_PAGES;
+	
 	pthread_mutex_unlock(&policy->lock);
 	
 	return true;
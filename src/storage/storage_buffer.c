@@ -1,261 +1,1906 @@
 /* storage_buffer.c - Thread-safe circular memory buffer implementation
  *
- * Implements a circular buffer for storing recent network events with
- * thread-safe access using read-write locks for concurrent readers.
+ * Implements a circular buffer for storing recent network events. Adding
+ * and clearing are serialized by the writer lock, readers take no lock.
+ * Event headers are stored as columns, one array per field, so that
+ * queries only touch the fields they filter on. Each row has a sequence
+ * counter that is odd while the writer changes the row, and the position
+ * of its event. Readers copy out what they need and retry if the counter
+ * changed, so queries never hold up ingestion.
+ *
+ * Interface names and event types are interned as small keys. Every
+ * block of rows has a summary of its time and message type range and of
+ * the keys it holds, which lets queries skip blocks without looking at
+ * their rows. Indexed buffers also chain the rows of each key, oldest
+ * first, so that queries for one interface or event type only visit
+ * the rows carrying it.
+ *
+ * A reader may still use an event the writer has just evicted. Evicted
+ * events are therefore retired rather than released, and released once
+ * two epoch flips have passed without readers, as the filter manager
+ * waits for its snapshots. The writer checks for that on every add and
+ * never waits for readers itself.
+ *
+ * With a history budget set, the events are not lost on eviction. Before
+ * the oldest event of a run leaves the buffer, the writer seals the run
+ * into a history block: timestamps and sequence numbers as deltas, the
+ * interface by its interned key, every field as a varint, the block then
+ * deflated. Each block keeps the summary of its rows. Queries reach the
+ * history before the buffer, and only inflate the blocks their summaries
+ * do not rule out. Blocks are immutable and refcounted, so the list lock
+ * is held only to take references, never while a block is decoded.
  */
 
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <fnmatch.h>
+#include <zlib.h>
 #include "storage_buffer.h"
+#include "filter_parser.h"
 #include "event_processor.h"
+#include "memory_governor.h"
+#include "huge_alloc.h"
+
+/* Interned keys, events beyond the limit get KEY_NONE */
+#define MAX_ATOMS 256
+#define MAX_TYPES 64
+#define ATOM_HASH_SIZE 512
+#define TYPE_HASH_SIZE 128
+#define KEY_NONE 0xffff
+
+/* Rows per block summary */
+#define BLOCK_SHIFT 10
+
+/* Events per history block */
+#define HISTORY_ROWS (1 << BLOCK_SHIFT)
+
+/* Encoded bytes of an event besides its data, an upper bound */
+#define HISTORY_RECORD_MAX 160
+
+/* Block summary key bit, the last one stands for KEY_NONE */
+#define KEY_BIT(key) ((key) == KEY_NONE ? 1ULL << 63 : 1ULL << ((key) % 63))
+
+/* Parts of a row to load besides the filter columns */
+#define ROW_HEADER 0x01
+#define ROW_EVENT  0x02
+#define ROW_LINKS  0x04
+
+/* Row columns, written by the writer only */
+struct storage_columns {
+	_Atomic unsigned *seq;            /* Odd while the row changes */
+	_Atomic uint64_t *pos;            /* Position of the event + 1, 0 if empty */
+	_Atomic uint64_t *timestamp;
+	_Atomic uint64_t *sequence;
+	_Atomic uint32_t *event_type;
+	_Atomic uint16_t *message_type;
+	_Atomic uint16_t *atom;           /* Interface key */
+	_Atomic uint16_t *type_key;       /* Event type key */
+	_Atomic uint64_t (*interface)[2];
+	struct nlmon_event *_Atomic *event;
+	
+	/* Indexed buffers only, position + 1 of the next row with the key */
+	_Atomic uint64_t *next_atom;
+	_Atomic uint64_t *next_type;
+};
+
+/* Reader copy of a row */
+struct storage_row {
+	uint64_t timestamp;
+	uint64_t sequence;
+	uint32_t event_type;
+	uint16_t message_type;
+	uint16_t atom;
+	uint64_t interface[2];
+	uint64_t next_atom;
+	uint64_t next_type;
+	struct nlmon_event *event;
+};
+
+/* Summary of the rows of one block */
+struct block_summary {
+	_Atomic unsigned seq;             /* Odd while the summary changes */
+	_Atomic uint64_t block;           /* Block number + 1 */
+	_Atomic uint64_t min_timestamp;
+	_Atomic uint64_t max_timestamp;
+	_Atomic uint64_t atoms;           /* KEY_BIT of the atoms present */
+	_Atomic uint64_t types;           /* KEY_BIT of the type keys present */
+	_Atomic uint32_t min_message_type;
+	_Atomic uint32_t max_message_type;
+};
+
+/* Rows of one key, oldest first */
+struct posting {
+	_Atomic uint64_t first;           /* Position + 1 of the oldest row, 0 if none */
+	_Atomic uint64_t count;           /* Rows in the buffer */
+	uint64_t last;                    /* Position + 1 of the newest row, writer only */
+};
+
+/* Events sealed out of the buffer, immutable once published */
+struct history_block {
+	_Atomic unsigned refs;            /* The list's and each reader's */
+	uint64_t first;                   /* Position of the first event */
+	uint64_t count;
+	uint64_t min_timestamp;
+	uint64_t max_timestamp;
+	uint64_t atoms;                   /* KEY_BIT of the atoms present */
+	uint64_t types;                   /* KEY_BIT of the type keys present */
+	uint32_t min_message_type;
+	uint32_t max_message_type;
+	size_t raw_size;                  /* Encoded bytes */
+	size_t size;                      /* Deflated bytes */
+	uint8_t data[];
+};
+
+/* Events waiting until no reader can hold them */
+struct retire_list {
+	struct nlmon_event **events;
+	size_t count;
+	size_t size;
+};
 
 /* Storage buffer structure */
 struct storage_buffer {
-	struct nlmon_event *events;     /* Circular array of events */
+	struct storage_columns cols;    /* Circular arrays of event headers */
 	size_t capacity;                /* Maximum capacity */
-	size_t head;                    /* Write position */
-	size_t count;                   /* Current count */
-	pthread_rwlock_t lock;          /* Read-write lock */
+	_Atomic uint64_t head;          /* Position of the next event */
+	_Atomic uint64_t tail;          /* Position of the oldest event */
+	pthread_mutex_t write_lock;     /* Serializes add and clear */
+	
+	/* Block summaries, by block number modulo num_blocks */
+	struct block_summary *blocks;
+	size_t num_blocks;
+	
+	/* Interned keys, published by their count */
+	_Atomic uint64_t atom_names[MAX_ATOMS][2];
+	_Atomic unsigned num_atoms;
+	_Atomic bool atoms_full;        /* Some interface got KEY_NONE */
+	_Atomic uint32_t type_values[MAX_TYPES];
+	_Atomic unsigned num_types;
+	_Atomic bool types_full;
+	uint16_t atom_hash[ATOM_HASH_SIZE];   /* Writer only */
+	uint16_t type_hash[TYPE_HASH_SIZE];
+	
+	/* Secondary indexes, NULL if not indexed */
+	struct posting *atom_postings;
+	struct posting *type_postings;
+	
+	/* Read side sections */
+	_Atomic unsigned readers[2];    /* Readers in progress per epoch */
+	_Atomic unsigned epoch;
+	
+	/* Evicted events, guarded by write_lock */
+	struct retire_list retired;     /* Retired since the grace period began */
+	struct retire_list grace;       /* Released when the grace period ends */
+	int grace_phase;                /* Flips done, 0 if no grace period runs */
+	unsigned grace_idx;             /* Readers counter to drain */
+	
+	/* Memory, see storage_buffer_set_limit() */
+	_Atomic size_t limit;           /* Events kept, 0 for capacity */
+	size_t fixed_bytes;             /* Columns, blocks and postings */
+	_Atomic size_t event_bytes;     /* Events held */
+	
+	/* History, see storage_buffer_set_history() */
+	pthread_mutex_t history_lock;   /* Guards the block list and its totals */
+	struct history_block **history; /* Oldest first */
+	size_t history_count;
+	size_t history_size;
+	size_t history_max;             /* Bytes configured, 0 if off, writer lock */
+	_Atomic size_t history_cap;     /* Bytes kept, lowered under pressure */
+	_Atomic size_t history_bytes;   /* Blocks held */
+	_Atomic uint64_t history_raw;   /* Encoded bytes of the blocks held */
+	_Atomic uint64_t history_events;
+	uint64_t history_next;          /* Position the next block starts at, writer only */
+	uint8_t *scratch;               /* Encoding buffer, writer only */
+	size_t scratch_size;
+	
+	/* Statistics */
+	_Atomic unsigned long total_added;
+	_Atomic unsigned long total_overflows;
+	_Atomic unsigned long peak_usage;
+};
+
+/* Enter a read side section, returns the counter to leave it through */
+static unsigned read_lock(struct storage_buffer *sb)
+{
+	unsigned idx = atomic_load(&sb->epoch) & 1;
+	
+	atomic_fetch_add(&sb->readers[idx], 1);
+	return idx;
+}
+
+static void read_unlock(struct storage_buffer *sb, unsigned idx)
+{
+	atomic_fetch_sub(&sb->readers[idx], 1);
+}
+
+/* Wait until no section can still see an evicted event, writer only */
+static void synchronize(struct storage_buffer *sb)
+{
+	for (int flip = 0; flip < 2; flip++) {
+		unsigned idx = atomic_fetch_add(&sb->epoch, 1) & 1;
+		
+		while (atomic_load(&sb->readers[idx]) != 0)
+			sched_yield();
+	}
+}
+
+static void retire_release(struct retire_list *list)
+{
+	for (size_t i = 0; i < list->count; i++)
+		nlmon_event_put(list->events[i]);
+	list->count = 0;
+}
+
+/* Release the events of a grace period that has ended, without waiting */
+static void reclaim(struct storage_buffer *sb)
+{
+	struct retire_list swap;
+	
+	switch (sb->grace_phase) {
+	case 0:
+		if (sb->retired.count == 0)
+			return;
+		
+		/* Start a grace period for what was retired so far */
+		swap = sb->grace;
+		sb->grace = sb->retired;
+		sb->retired = swap;
+		sb->grace_idx = atomic_fetch_add(&sb->epoch, 1) & 1;
+		sb->grace_phase = 1;
+		/* fall through */
+	case 1:
+		if (atomic_load(&sb->readers[sb->grace_idx]) != 0)
+			return;
+		sb->grace_idx = atomic_fetch_add(&sb->epoch, 1) & 1;
+		sb->grace_phase = 2;
+		/* fall through */
+	default:
+		if (atomic_load(&sb->readers[sb->grace_idx]) != 0)
+			return;
+		retire_release(&sb->grace);
+		sb->grace_phase = 0;
+	}
+}
+
+/* Bytes an event holds, as if the buffer held it alone */
+static size_t event_size(const struct nlmon_event *event)
+{
+	return sizeof(*event) + event->data_size;
+}
+
+/* Release event once no reader can hold it, writer lock held */
+static void retire(struct storage_buffer *sb, struct nlmon_event *event)
+{
+	struct retire_list *list = &sb->retired;
+	
+	atomic_fetch_sub_explicit(&sb->event_bytes, event_size(event), memory_order_relaxed);
+	
+	if (list->count == list->size) {
+		size_t size = list->size ? list->size * 2 : 64;
+		struct nlmon_event **events = realloc(list->events, size * sizeof(*events));
+		
+		if (!events) {
+			/* Out of memory, wait for the readers instead */
+			synchronize(sb);
+			retire_release(&sb->retired);
+			retire_release(&sb->grace);
+			sb->grace_phase = 0;
+			nlmon_event_put(event);
+			return;
+		}
+		list->events = events;
+		list->size = size;
+	}
+	
+	list->events[list->count++] = event;
+}
+
+static uint32_t key_hash(const void *key, size_t len)
+{
+	const unsigned char *p = key;
+	uint32_t hash = 2166136261u;
+	
+	for (size_t i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* Interface key of an event, interned if new, writer lock held */
+static uint16_t atom_intern(struct storage_buffer *sb, const char *interface)
+{
+	uint64_t name[2];
+	uint32_t hash;
+	unsigned count;
+	
+	memcpy(name, interface, sizeof(name));
+	hash = key_hash(name, sizeof(name));
+	
+	for (uint32_t i = 0; i < ATOM_HASH_SIZE; i++) {
+		uint16_t atom = sb->atom_hash[(hash + i) & (ATOM_HASH_SIZE - 1)];
+		
+		if (atom == KEY_NONE)
+			break;
+		if (atomic_load_explicit(&sb->atom_names[atom][0], memory_order_relaxed) == name[0] &&
+		    atomic_load_explicit(&sb->atom_names[atom][1], memory_order_relaxed) == name[1])
+			return atom;
+	}
+	
+	count = atomic_load_explicit(&sb->num_atoms, memory_order_relaxed);
+	if (count == MAX_ATOMS) {
+		atomic_store_explicit(&sb->atoms_full, true, memory_order_relaxed);
+		return KEY_NONE;
+	}
+	
+	/* Publish the name before the atom count */
+	atomic_store_explicit(&sb->atom_names[count][0], name[0], memory_order_relaxed);
+	atomic_store_explicit(&sb->atom_names[count][1], name[1], memory_order_relaxed);
+	atomic_store_explicit(&sb->num_atoms, count + 1, memory_order_release);
+	
+	for (uint32_t i = 0; ; i++) {
+		uint16_t *slot = &sb->atom_hash[(hash + i) & (ATOM_HASH_SIZE - 1)];
+		
+		if (*slot == KEY_NONE) {
+			*slot = (uint16_t)count;
+			return (uint16_t)count;
+		}
+	}
+}
+
+/* Event type key, interned if new, writer lock held */
+static uint16_t type_intern(struct storage_buffer *sb, uint32_t event_type)
+{
+	uint32_t hash = key_hash(&event_type, sizeof(event_type));
+	unsigned count;
+	
+	for (uint32_t i = 0; i < TYPE_HASH_SIZE; i++) {
+		uint16_t key = sb->type_hash[(hash + i) & (TYPE_HASH_SIZE - 1)];
+		
+		if (key == KEY_NONE)
+			break;
+		if (atomic_load_explicit(&sb->type_values[key], memory_order_relaxed) == event_type)
+			return key;
+	}
+	
+	count = atomic_load_explicit(&sb->num_types, memory_order_relaxed);
+	if (count == MAX_TYPES) {
+		atomic_store_explicit(&sb->types_full, true, memory_order_relaxed);
+		return KEY_NONE;
+	}
+	
+	atomic_store_explicit(&sb->type_values[count], event_type, memory_order_relaxed);
+	atomic_store_explicit(&sb->num_types, count + 1, memory_order_release);
+	
+	for (uint32_t i = 0; ; i++) {
+		uint16_t *slot = &sb->type_hash[(hash + i) & (TYPE_HASH_SIZE - 1)];
+		
+		if (*slot == KEY_NONE) {
+			*slot = (uint16_t)count;
+			return (uint16_t)count;
+		}
+	}
+}
+
+/* Type key of event_type for readers, KEY_NONE if it was never stored */
+static uint16_t type_lookup(struct storage_buffer *sb, uint32_t event_type)
+{
+	unsigned count = atomic_load_explicit(&sb->num_types, memory_order_acquire);
+	
+	for (unsigned i = 0; i < count; i++) {
+		if (atomic_load_explicit(&sb->type_values[i], memory_order_relaxed) == event_type)
+			return (uint16_t)i;
+	}
+	return KEY_NONE;
+}
+
+/* Put the event at pos into row, writer lock held */
+static void row_store(struct storage_buffer *sb, size_t row, uint64_t pos,
+                      struct nlmon_event *event, uint16_t atom, uint16_t type_key)
+{
+	struct storage_columns *c = &sb->cols;
+	unsigned seq = atomic_load_explicit(&c->seq[row], memory_order_relaxed);
+	uint64_t name[2] = { 0, 0 };
+	
+	if (event)
+		memcpy(name, event->interface, sizeof(name));
+	
+	atomic_store_explicit(&c->seq[row], seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	
+	atomic_store_explicit(&c->pos[row], event ? pos + 1 : 0, memory_order_relaxed);
+	atomic_store_explicit(&c->timestamp[row], event ? event->timestamp : 0, memory_order_relaxed);
+	atomic_store_explicit(&c->sequence[row], event ? event->sequence : 0, memory_order_relaxed);
+	atomic_store_explicit(&c->event_type[row], event ? event->event_type : 0, memory_order_relaxed);
+	atomic_store_explicit(&c->message_type[row], event ? event->message_type : 0,
+	                      memory_order_relaxed);
+	atomic_store_explicit(&c->atom[row], atom, memory_order_relaxed);
+	atomic_store_explicit(&c->type_key[row], type_key, memory_order_relaxed);
+	atomic_store_explicit(&c->interface[row][0], name[0], memory_order_relaxed);
+	atomic_store_explicit(&c->interface[row][1], name[1], memory_order_relaxed);
+	atomic_store_explicit(&c->event[row], event, memory_order_relaxed);
+	if (sb->atom_postings) {
+		atomic_store_explicit(&c->next_atom[row], 0, memory_order_relaxed);
+		atomic_store_explicit(&c->next_type[row], 0, memory_order_relaxed);
+	}
+	
+	atomic_store_explicit(&c->seq[row], seq + 2, memory_order_release);
+}
+
+/*
+ * Copy the row holding the event at pos, with the parts in flags. Fails
+ * if the row holds another position. The event reference may only be
+ * used inside a read side section.
+ */
+static bool row_load(struct storage_buffer *sb, uint64_t pos, int flags,
+                     struct storage_row *out)
+{
+	struct storage_columns *c = &sb->cols;
+	size_t row = pos % sb->capacity;
+	uint64_t held;
+	unsigned seq;
+	
+	for (;;) {
+		seq = atomic_load_explicit(&c->seq[row], memory_order_acquire);
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+		
+		held = atomic_load_explicit(&c->pos[row], memory_order_relaxed);
+		out->timestamp = atomic_load_explicit(&c->timestamp[row], memory_order_relaxed);
+		out->event_type = atomic_load_explicit(&c->event_type[row], memory_order_relaxed);
+		out->message_type = atomic_load_explicit(&c->message_type[row], memory_order_relaxed);
+		out->atom = atomic_load_explicit(&c->atom[row], memory_order_relaxed);
+		if ((flags & ROW_HEADER) || out->atom == KEY_NONE) {
+			out->sequence = atomic_load_explicit(&c->sequence[row], memory_order_relaxed);
+			out->interface[0] = atomic_load_explicit(&c->interface[row][0], memory_order_relaxed);
+			out->interface[1] = atomic_load_explicit(&c->interface[row][1], memory_order_relaxed);
+		}
+		if (flags & ROW_EVENT)
+			out->event = atomic_load_explicit(&c->event[row], memory_order_relaxed);
+		if (flags & ROW_LINKS) {
+			out->next_atom = atomic_load_explicit(&c->next_atom[row], memory_order_relaxed);
+			out->next_type = atomic_load_explicit(&c->next_type[row], memory_order_relaxed);
+		}
+		
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&c->seq[row], memory_order_relaxed) == seq)
+			break;
+	}
+	
+	return held == pos + 1;
+}
+
+static void row_header(struct buffer_event_header *header, const struct storage_row *row)
+{
+	header->timestamp = row->timestamp;
+	header->sequence = row->sequence;
+	header->event_type = row->event_type;
+	header->message_type = row->message_type;
+	memcpy(header->interface, row->interface, sizeof(header->interface));
+}
+
+/* Widen the summary of the block of pos by an event, writer lock held */
+static void summary_add(struct storage_buffer *sb, uint64_t pos,
+                        const struct nlmon_event *event, uint16_t atom, uint16_t type_key)
+{
+	uint64_t block = pos >> BLOCK_SHIFT;
+	struct block_summary *s = &sb->blocks[block % sb->num_blocks];
+	unsigned seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+	
+	atomic_store_explicit(&s->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	
+	if (atomic_load_explicit(&s->block, memory_order_relaxed) != block + 1) {
+		/* First event of the block, the entry's old block is all evicted */
+		atomic_store_explicit(&s->block, block + 1, memory_order_relaxed);
+		atomic_store_explicit(&s->min_timestamp, event->timestamp, memory_order_relaxed);
+		atomic_store_explicit(&s->max_timestamp, event->timestamp, memory_order_relaxed);
+		atomic_store_explicit(&s->atoms, KEY_BIT(atom), memory_order_relaxed);
+		atomic_store_explicit(&s->types, KEY_BIT(type_key), memory_order_relaxed);
+		atomic_store_explicit(&s->min_message_type, event->message_type, memory_order_relaxed);
+		atomic_store_explicit(&s->max_message_type, event->message_type, memory_order_relaxed);
+	} else {
+		if (event->timestamp < atomic_load_explicit(&s->min_timestamp, memory_order_relaxed))
+			atomic_store_explicit(&s->min_timestamp, event->timestamp, memory_order_relaxed);
+		if (event->timestamp > atomic_load_explicit(&s->max_timestamp, memory_order_relaxed))
+			atomic_store_explicit(&s->max_timestamp, event->timestamp, memory_order_relaxed);
+		atomic_fetch_or_explicit(&s->atoms, KEY_BIT(atom), memory_order_relaxed);
+		atomic_fetch_or_explicit(&s->types, KEY_BIT(type_key), memory_order_relaxed);
+		if (event->message_type < atomic_load_explicit(&s->min_message_type, memory_order_relaxed))
+			atomic_store_explicit(&s->min_message_type, event->message_type, memory_order_relaxed);
+		if (event->message_type > atomic_load_explicit(&s->max_message_type, memory_order_relaxed))
+			atomic_store_explicit(&s->max_message_type, event->message_type, memory_order_relaxed);
+	}
+	
+	atomic_store_explicit(&s->seq, seq + 2, memory_order_release);
+}
+
+/* Append pos to the chain of one key, writer lock held */
+static void posting_append(struct storage_buffer *sb, struct posting *p,
+                           _Atomic uint64_t *next, uint64_t pos)
+{
+	uint64_t tail = atomic_load_explicit(&sb->tail, memory_order_relaxed);
+	
+	if (p->last > tail)
+		atomic_store_explicit(&next[(p->last - 1) % sb->capacity], pos + 1, memory_order_relaxed);
+	else
+		atomic_store_explicit(&p->first, pos + 1, memory_order_relaxed);
+	p->last = pos + 1;
+	atomic_fetch_add_explicit(&p->count, 1, memory_order_relaxed);
+}
+
+/* Unchain the oldest row before it is overwritten, writer lock held */
+static void posting_evict(struct storage_buffer *sb, size_t row)
+{
+	struct storage_columns *c = &sb->cols;
+	uint16_t atom = atomic_load_explicit(&c->atom[row], memory_order_relaxed);
+	uint16_t type_key = atomic_load_explicit(&c->type_key[row], memory_order_relaxed);
+	struct posting *p;
+	
+	if (atom != KEY_NONE) {
+		p = &sb->atom_postings[atom];
+		atomic_store_explicit(&p->first,
+		                      atomic_load_explicit(&c->next_atom[row], memory_order_relaxed),
+		                      memory_order_relaxed);
+		atomic_fetch_sub_explicit(&p->count, 1, memory_order_relaxed);
+	}
+	
+	if (type_key != KEY_NONE) {
+		p = &sb->type_postings[type_key];
+		atomic_store_explicit(&p->first,
+		                      atomic_load_explicit(&c->next_type[row], memory_order_relaxed),
+		                      memory_order_relaxed);
+		atomic_fetch_sub_explicit(&p->count, 1, memory_order_relaxed);
+	}
+}
+
+static uint8_t *put_varint(uint8_t *p, uint64_t value)
+{
+	while (value >= 0x80) {
+		*p++ = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	*p++ = (uint8_t)value;
+	return p;
+}
+
+static bool get_varint(const uint8_t **p, const uint8_t *end, uint64_t *value)
+{
+	uint64_t v = 0;
+	
+	for (unsigned shift = 0; shift < 64; shift += 7) {
+		uint8_t byte;
+		
+		if (*p == end)
+			return false;
+		byte = *(*p)++;
+		v |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			*value = v;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Deltas may be negative, keep small ones short either way */
+static uint64_t zigzag(uint64_t delta)
+{
+	return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+}
+
+static uint64_t unzigzag(uint64_t value)
+{
+	return (value >> 1) ^ (0 - (value & 1));
+}
+
+static void history_put(struct history_block *block)
+{
+	if (atomic_fetch_sub_explicit(&block->refs, 1, memory_order_acq_rel) == 1)
+		free(block);
+}
+
+/* Drop the oldest blocks until the history fits cap */
+static void history_trim(struct storage_buffer *sb, size_t cap)
+{
+	size_t drop = 0, bytes;
+	
+	pthread_mutex_lock(&sb->history_lock);
+	
+	bytes = atomic_load_explicit(&sb->history_bytes, memory_order_relaxed);
+	while (drop < sb->history_count && bytes > cap) {
+		struct history_block *block = sb->history[drop++];
+		
+		bytes -= sizeof(*block) + block->size;
+		atomic_fetch_sub_explicit(&sb->history_raw, block->raw_size, memory_order_relaxed);
+		atomic_fetch_sub_explicit(&sb->history_events, block->count, memory_order_relaxed);
+		history_put(block);
+	}
+	
+	if (drop) {
+		sb->history_count -= drop;
+		memmove(sb->history, sb->history + drop, sb->history_count * sizeof(*sb->history));
+		atomic_store_explicit(&sb->history_bytes, bytes, memory_order_relaxed);
+	}
+	
+	pthread_mutex_unlock(&sb->history_lock);
+}
+
+/* Make room for size more encoded bytes, writer lock held */
+static bool scratch_reserve(struct storage_buffer *sb, size_t used, size_t size)
+{
+	size_t want = sb->scratch_size ? sb->scratch_size : 4096;
+	uint8_t *scratch;
+	
+	if (used + size <= sb->scratch_size)
+		return true;
+	
+	while (want < used + size)
+		want *= 2;
+	scratch = realloc(sb->scratch, want);
+	if (!scratch)
+		return false;
+	
+	sb->scratch = scratch;
+	sb->scratch_size = want;
+	return true;
+}
+
+/* Append an event to the encoding, returns the new end */
+static uint8_t *history_encode(uint8_t *p, const struct nlmon_event *event, uint16_t atom,
+                               uint64_t *prev_timestamp, uint64_t *prev_sequence)
+{
+	size_t family_len = strnlen(event->netlink.genl_family_name,
+	                            sizeof(event->netlink.genl_family_name));
+	
+	p = put_varint(p, zigzag(event->timestamp - *prev_timestamp));
+	p = put_varint(p, zigzag(event->sequence - *prev_sequence));
+	*prev_timestamp = event->timestamp;
+	*prev_sequence = event->sequence;
+	
+	p = put_varint(p, event->event_type);
+	p = put_varint(p, event->message_type);
+	
+	/* The interned key is the dictionary, only names without one are spelled out */
+	p = put_varint(p, atom);
+	if (atom == KEY_NONE) {
+		memcpy(p, event->interface, sizeof(event->interface));
+		p += sizeof(event->interface);
+	}
+	
+	/* Parsed attributes and the raw message are not kept */
+	p = put_varint(p, zigzag((uint64_t)(int64_t)event->netlink.protocol));
+	p = put_varint(p, event->netlink.msg_type);
+	p = put_varint(p, event->netlink.msg_flags);
+	p = put_varint(p, event->netlink.seq);
+	p = put_varint(p, event->netlink.pid);
+	p = put_varint(p, event->netlink.netns);
+	p = put_varint(p, event->netlink.genl_cmd);
+	p = put_varint(p, event->netlink.genl_version);
+	p = put_varint(p, event->netlink.genl_family_id);
+	p = put_varint(p, family_len);
+	memcpy(p, event->netlink.genl_family_name, family_len);
+	p += family_len;
+	
+	p = put_varint(p, event->data ? event->data_size : 0);
+	if (event->data && event->data_size) {
+		memcpy(p, event->data, event->data_size);
+		p += event->data_size;
+	}
+	
+	return p;
+}
+
+/* Seal the events at [first, end) into a history block, writer lock held */
+static void history_seal(struct storage_buffer *sb, uint64_t first, uint64_t end)
+{
+	struct storage_columns *c = &sb->cols;
+	struct history_block *block, *shrunk;
+	uint64_t prev_timestamp = 0, prev_sequence = 0;
+	uLongf size;
+	size_t used = 0;
+	
+	block = calloc(1, sizeof(*block));
+	if (!block)
+		return;
+	block->first = first;
+	block->count = end - first;
+	block->min_timestamp = UINT64_MAX;
+	block->min_message_type = UINT32_MAX;
+	
+	for (uint64_t pos = first; pos < end; pos++) {
+		size_t row = pos % sb->capacity;
+		struct nlmon_event *event = atomic_load_explicit(&c->event[row], memory_order_relaxed);
+		uint16_t atom = atomic_load_explicit(&c->atom[row], memory_order_relaxed);
+		uint16_t type_key = atomic_load_explicit(&c->type_key[row], memory_order_relaxed);
+		size_t data_size = event && event->data ? event->data_size : 0;
+		
+		/* Out of memory, these events are lost like those before history */
+		if (!event || !scratch_reserve(sb, used, HISTORY_RECORD_MAX + data_size)) {
+			free(block);
+			return;
+		}
+		
+		used = (size_t)(history_encode(sb->scratch + used, event, atom,
+		                               &prev_timestamp, &prev_sequence) - sb->scratch);
+		
+		if (event->timestamp < block->min_timestamp)
+			block->min_timestamp = event->timestamp;
+		if (event->timestamp > block->max_timestamp)
+			block->max_timestamp = event->timestamp;
+		if (event->message_type < block->min_message_type)
+			block->min_message_type = event->message_type;
+		if (event->message_type > block->max_message_type)
+			block->max_message_type = event->message_type;
+		block->atoms |= KEY_BIT(atom);
+		block->types |= KEY_BIT(type_key);
+	}
+	
+	/* Fastest level, sealing runs on the add path */
+	size = compressBound(used);
+	shrunk = realloc(block, sizeof(*block) + size);
+	if (!shrunk) {
+		free(block);
+		return;
+	}
+	block = shrunk;
+	if (compress2(block->data, &size, sb->scratch, used, Z_BEST_SPEED) != Z_OK) {
+		free(block);
+		return;
+	}
+	shrunk = realloc(block, sizeof(*block) + size);
+	if (shrunk)
+		block = shrunk;
+	block->raw_size = used;
+	block->size = size;
+	atomic_init(&block->refs, 1);
+	
+	pthread_mutex_lock(&sb->history_lock);
+	
+	if (sb->history_count == sb->history_size) {
+		size_t count = sb->history_size ? sb->history_size * 2 : 16;
+		struct history_block **history = realloc(sb->history, count * sizeof(*history));
+		
+		if (!history) {
+			pthread_mutex_unlock(&sb->history_lock);
+			free(block);
+			return;
+		}
+		sb->history = history;
+		sb->history_size = count;
+	}
+	sb->history[sb->history_count++] = block;
+	atomic_fetch_add_explicit(&sb->history_bytes, sizeof(*block) + block->size,
+	                          memory_order_relaxed);
+	atomic_fetch_add_explicit(&sb->history_raw, block->raw_size, memory_order_relaxed);
+	atomic_fetch_add_explicit(&sb->history_events, block->count, memory_order_relaxed);
+	
+	pthread_mutex_unlock(&sb->history_lock);
+	
+	history_trim(sb, atomic_load_explicit(&sb->history_cap, memory_order_relaxed));
+}
+
+/*
+ * Seal the run starting at tail before its first event leaves, writer
+ * lock held. The block is published before the tail moves on, so readers
+ * find every event either in the buffer or in the history.
+ */
+static void history_evict(struct storage_buffer *sb, uint64_t tail)
+{
+	uint64_t head, end;
+	
+	if (!sb->history_max || tail < sb->history_next)
+		return;
+	
+	head = atomic_load_explicit(&sb->head, memory_order_relaxed);
+	end = tail + HISTORY_ROWS < head ? tail + HISTORY_ROWS : head;
+	history_seal(sb, tail, end);
+	sb->history_next = end;
+}
+
+/* Drop the oldest event and empty its row, writer lock held */
+static void evict_oldest(struct storage_buffer *sb, uint64_t tail)
+{
+	size_t row = tail % sb->capacity;
+	struct nlmon_event *event = atomic_load_explicit(&sb->cols.event[row], memory_order_relaxed);
+	
+	history_evict(sb, tail);
+	if (sb->atom_postings)
+		posting_evict(sb, row);
+	atomic_store_explicit(&sb->tail, tail + 1, memory_order_release);
+	atomic_fetch_add_explicit(&sb->total_overflows, 1, memory_order_relaxed);
+	
+	row_store(sb, row, tail, NULL, KEY_NONE, KEY_NONE);
+	if (event)
+		retire(sb, event);
+}
+
+/* Positions of the stored events, oldest first */
+static void buffer_range(struct storage_buffer *sb, uint64_t *tail, uint64_t *head)
+{
+	*tail = atomic_load_explicit(&sb->tail, memory_order_acquire);
+	*head = atomic_load_explicit(&sb->head, memory_order_acquire);
+	if (*head < *tail)
+		*head = *tail;
+}
+
+static void columns_free(struct storage_columns *c)
+{
+	huge_free(c->seq);
+	huge_free(c->pos);
+	huge_free(c->timestamp);
+	huge_free(c->sequence);
+	huge_free(c->event_type);
+	huge_free(c->message_type);
+	huge_free(c->atom);
+	huge_free(c->type_key);
+	huge_free(c->interface);
+	huge_free(c->event);
+	huge_free(c->next_atom);
+	huge_free(c->next_type);
+}
+
+static int columns_alloc(struct storage_columns *c, size_t capacity, bool indexed)
+{
+	c->seq = huge_calloc(capacity, sizeof(*c->seq), 0, "storage_buffer");
+	c->pos = huge_calloc(capacity, sizeof(*c->pos), 0, "storage_buffer");
+	c->timestamp = huge_calloc(capacity, sizeof(*c->timestamp), 0, "storage_buffer");
+	c->sequence = huge_calloc(capacity, sizeof(*c->sequence), 0, "storage_buffer");
+	c->event_type = huge_calloc(capacity, sizeof(*c->event_type), 0, "storage_buffer");
+	c->message_type = huge_calloc(capacity, sizeof(*c->message_type), 0, "storage_buffer");
+	c->atom = huge_calloc(capacity, sizeof(*c->atom), 0, "storage_buffer");
+	c->type_key = huge_calloc(capacity, sizeof(*c->type_key), 0, "storage_buffer");
+	c->interface = huge_calloc(capacity, sizeof(*c->interface), 0, "storage_buffer");
+	c->event = huge_calloc(capacity, sizeof(*c->event), 0, "storage_buffer");
+	
+	if (!c->seq || !c->pos || !c->timestamp || !c->sequence || !c->event_type ||
+	    !c->message_type || !c->atom || !c->type_key || !c->interface || !c->event)
+		goto fail;
+	
+	if (indexed) {
+		c->next_atom = huge_calloc(capacity, sizeof(*c->next_atom), 0, "storage_buffer");
+		c->next_type = huge_calloc(capacity, sizeof(*c->next_type), 0, "storage_buffer");
+		if (!c->next_atom || !c->next_type)
+			goto fail;
+	}
+	
+	return 0;
+	
+fail:
+	columns_free(c);
+	return -1;
+}
+
+static struct storage_buffer *buffer_create(size_t capacity, bool indexed)
+{
+	struct storage_buffer *sb;
+	
+	if (capacity == 0)
+		return NULL;
+	
+	sb = calloc(1, sizeof(*sb));
+	if (!sb)
+		return NULL;
+	
+	if (columns_alloc(&sb->cols, capacity, indexed) < 0) {
+		free(sb);
+		return NULL;
+	}
+	
+	/* One entry more than the blocks a full buffer spans */
+	sb->num_blocks = (capacity >> BLOCK_SHIFT) + 2;
+	sb->blocks = calloc(sb->num_blocks, sizeof(*sb->blocks));
+	if (!sb->blocks)
+		goto fail;
+	
+	if (indexed) {
+		sb->atom_postings = calloc(MAX_ATOMS, sizeof(*sb->atom_postings));
+		sb->type_postings = calloc(MAX_TYPES, sizeof(*sb->type_postings));
+		if (!sb->atom_postings || !sb->type_postings)
+			goto fail;
+	}
+	
+	sb->capacity = capacity;
+	sb->fixed_bytes = sizeof(*sb) + sb->num_blocks * sizeof(*sb->blocks) +
+	                  capacity * (sizeof(*sb->cols.seq) + sizeof(*sb->cols.pos) +
+	                              sizeof(*sb->cols.timestamp) + sizeof(*sb->cols.sequence) +
+	                              sizeof(*sb->cols.event_type) + sizeof(*sb->cols.message_type) +
+	                              sizeof(*sb->cols.atom) + sizeof(*sb->cols.type_key) +
+	                              sizeof(*sb->cols.interface) + sizeof(*sb->cols.event));
+	if (indexed)
+		sb->fixed_bytes += capacity * (sizeof(*sb->cols.next_atom) + sizeof(*sb->cols.next_type)) +
+		                   MAX_ATOMS * sizeof(*sb->atom_postings) +
+		                   MAX_TYPES * sizeof(*sb->type_postings);
+	memset(sb->atom_hash, 0xff, sizeof(sb->atom_hash));
+	memset(sb->type_hash, 0xff, sizeof(sb->type_hash));
+	atomic_init(&sb->head, 0);
+	atomic_init(&sb->tail, 0);
+	atomic_init(&sb->readers[0], 0);
+	atomic_init(&sb->readers[1], 0);
+	atomic_init(&sb->epoch, 0);
+	
+	if (pthread_mutex_init(&sb->write_lock, NULL) != 0)
+		goto fail;
+	if (pthread_mutex_init(&sb->history_lock, NULL) != 0) {
+		pthread_mutex_destroy(&sb->write_lock);
+		goto fail;
+	}
+	
+	return sb;
+	
+fail:
+	free(sb->atom_postings);
+	free(sb->type_postings);
+	free(sb->blocks);
+	columns_free(&sb->cols);
+	free(sb);
+	return NULL;
+}
+
+struct storage_buffer *storage_buffer_create(size_t capacity)
+{
+	return buffer_create(capacity, false);
+}
+
+struct storage_buffer *storage_buffer_create_indexed(size_t capacity)
+{
+	return buffer_create(capacity, true);
+}
+
+void storage_buffer_destroy(struct storage_buffer *sb)
+{
+	if (!sb)
+		return;
+	
+	pthread_mutex_destroy(&sb->write_lock);
+	pthread_mutex_destroy(&sb->history_lock);
+	
+	/* Drop event references, no reader is left */
+	for (size_t i = 0; i < sb->capacity; i++) {
+		struct nlmon_event *event = atomic_load(&sb->cols.event[i]);
+		
+		if (event)
+			nlmon_event_put(event);
+	}
+	retire_release(&sb->retired);
+	retire_release(&sb->grace);
+	
+	for (size_t i = 0; i < sb->history_count; i++)
+		history_put(sb->history[i]);
+	
+	free(sb->history);
+	free(sb->scratch);
+	free(sb->retired.events);
+	free(sb->grace.events);
+	free(sb->atom_postings);
+	free(sb->type_postings);
+	free(sb->blocks);
+	columns_free(&sb->cols);
+	free(sb);
+}
+
+/* Copy a stored event out to a caller-owned event with its own data */
+static void storage_event_copy(struct nlmon_event *dst, const struct nlmon_event *src)
+{
+	*dst = *src;
+	dst->shared = NULL;
+	
+	if (nlmon_event_copy_data(dst, src->data, src->data_size) < 0)
+		dst->data = NULL;
+}
+
+bool storage_buffer_add(struct storage_buffer *sb, struct nlmon_event *event)
+{
+	struct nlmon_event *ref, *evicted;
+	uint16_t atom, type_key;
+	uint64_t head, tail;
+	unsigned long count;
+	size_t row, limit;
+	
+	if (!sb || !event)
+		return false;
+	
+	/* Take a reference, refcounted events are not copied */
+	ref = nlmon_event_share(event);
+	if (!ref)
+		return false;
+	
+	pthread_mutex_lock(&sb->write_lock);
+	
+	head = atomic_load_explicit(&sb->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&sb->tail, memory_order_relaxed);
+	
+	/* Under a limit, make room below it, the full buffer path stays as is */
+	limit = atomic_load_explicit(&sb->limit, memory_order_relaxed);
+	while (limit && head - tail >= limit)
+		evict_oldest(sb, tail++);
+	
+	row = head % sb->capacity;
+	evicted = atomic_load_explicit(&sb->cols.event[row], memory_order_relaxed);
+	
+	/* If buffer is full, drop the oldest event, readers see it go first */
+	if (head - tail == sb->capacity) {
+		history_evict(sb, tail);
+		if (sb->atom_postings)
+			posting_evict(sb, row);
+		atomic_store_explicit(&sb->tail, tail + 1, memory_order_release);
+		atomic_fetch_add_explicit(&sb->total_overflows, 1, memory_order_relaxed);
+		tail++;
+	}
+	
+	atom = atom_intern(sb, ref->interface);
+	type_key = type_intern(sb, ref->event_type);
+	
+	/* Summary and chains cover the row before head lets readers reach it */
+	summary_add(sb, head, ref, atom, type_key);
+	row_store(sb, row, head, ref, atom, type_key);
+	if (sb->atom_postings) {
+		if (atom != KEY_NONE)
+			posting_append(sb, &sb->atom_postings[atom], sb->cols.next_atom, head);
+		if (type_key != KEY_NONE)
+			posting_append(sb, &sb->type_postings[type_key], sb->cols.next_type, head);
+	}
+	atomic_store_explicit(&sb->head, head + 1, memory_order_release);
+	atomic_fetch_add_explicit(&sb->event_bytes, event_size(ref), memory_order_relaxed);
+	
+	if (evicted)
+		retire(sb, evicted);
+	reclaim(sb);
+	
+	/* Update statistics */
+	atomic_fetch_add_explicit(&sb->total_added, 1, memory_order_relaxed);
+	count = (unsigned long)(head + 1 - tail);
+	if (count > atomic_load_explicit(&sb->peak_usage, memory_order_relaxed))
+		atomic_store_explicit(&sb->peak_usage, count, memory_order_relaxed);
+	
+	pthread_mutex_unlock(&sb->write_lock);
+	
+	return true;
+}
+
+/* Reference of the event at index inside a read side section, NULL if none */
+static struct nlmon_event *buffer_lookup(struct storage_buffer *sb, size_t index)
+{
+	struct storage_row row;
+	uint64_t tail, head;
+	
+	for (;;) {
+		buffer_range(sb, &tail, &head);
+		if (index >= head - tail)
+			return NULL;
+		
+		if (row_load(sb, tail + index, ROW_EVENT, &row))
+			return row.event;
+		
+		/* The buffer moved on meanwhile, index now means another event */
+	}
+}
+
+bool storage_buffer_get(struct storage_buffer *sb, size_t index,
+                        struct nlmon_event *event)
+{
+	struct nlmon_event *stored;
+	unsigned idx;
+	
+	if (!sb || !event)
+		return false;
+	
+	idx = read_lock(sb);
+	
+	stored = buffer_lookup(sb, index);
+	if (stored)
+		storage_event_copy(event, stored);
+	
+	read_unlock(sb, idx);
+	
+	return stored != NULL;
+}
+
+size_t storage_buffer_get_latest(struct storage_buffer *sb, size_t count,
+                                 struct nlmon_event *events)
+{
+	struct storage_row row;
+	size_t retrieved = 0;
+	uint64_t tail, head, pos;
+	unsigned idx;
+	
+	if (!sb || !events)
+		return 0;
+	
+	idx = read_lock(sb);
+	
+	buffer_range(sb, &tail, &head);
+	
+	/* Get from newest to oldest, until the writer overtakes */
+	for (pos = head; pos > tail && retrieved < count; pos--) {
+		if (!row_load(sb, pos - 1, ROW_EVENT, &row))
+			break;
+		storage_event_copy(&events[retrieved++], row.event);
+	}
+	
+	read_unlock(sb, idx);
+	
+	return retrieved;
+}
+
+size_t storage_buffer_get_headers(struct storage_buffer *sb, size_t count,
+                                  struct buffer_event_header *headers)
+{
+	struct storage_row row;
+	size_t retrieved = 0;
+	uint64_t tail, head, pos;
+	
+	if (!sb || !headers)
+		return 0;
+	
+	/* Headers are copies, no event is referenced */
+	buffer_range(sb, &tail, &head);
+	
+	for (pos = head; pos > tail && retrieved < count; pos--) {
+		if (!row_load(sb, pos - 1, ROW_HEADER, &row))
+			break;
+		row_header(&headers[retrieved++], &row);
+	}
+	
+	return retrieved;
+}
+
+/* Position of the oldest event at or after (timestamp, sequence) */
+static uint64_t buffer_seek(struct storage_buffer *sb, uint64_t tail, uint64_t head,
+                            uint64_t timestamp, uint64_t sequence)
+{
+	struct storage_row row;
+	
+	while (tail < head) {
+		uint64_t mid = tail + (head - tail) / 2;
+		
+		/* Evicted under us, everything up to it is gone too */
+		if (!row_load(sb, mid, ROW_HEADER, &row)) {
+			tail = mid + 1;
+			continue;
+		}
+		
+		if (row.timestamp < timestamp ||
+		    (row.timestamp == timestamp && row.sequence < sequence))
+			tail = mid + 1;
+		else
+			head = mid;
+	}
+	
+	return tail;
+}
+
+size_t storage_buffer_get_headers_before(struct storage_buffer *sb,
+                                         uint64_t timestamp, uint64_t sequence,
+                                         size_t count, struct buffer_event_header *headers)
+{
+	struct storage_row row;
+	size_t retrieved = 0;
+	uint64_t tail, head, pos;
+	
+	if (!sb || !headers)
+		return 0;
+	
+	buffer_range(sb, &tail, &head);
+	
+	/* Seek instead of walking down from the newest event */
+	for (pos = buffer_seek(sb, tail, head, timestamp, sequence);
+	     pos > tail && retrieved < count; pos--) {
+		if (!row_load(sb, pos - 1, ROW_HEADER, &row))
+			break;
+		row_header(&headers[retrieved++], &row);
+	}
+	
+	return retrieved;
+}
+
+struct nlmon_event *storage_buffer_get_ref(struct storage_buffer *sb, size_t index)
+{
+	struct nlmon_event *event;
+	unsigned idx;
+	
+	if (!sb)
+		return NULL;
+	
+	idx = read_lock(sb);
+	
+	event = buffer_lookup(sb, index);
+	if (event)
+		event = nlmon_event_share(event);
+	
+	read_unlock(sb, idx);
+	
+	return event;
+}
+
+/* Outcome of a filter expression on the header columns */
+enum expr_result {
+	EXPR_FALSE,
+	EXPR_TRUE,
+	EXPR_UNKNOWN,                     /* Depends on fields headers lack */
+};
+
+/* Header column value of a field, false for fields headers lack */
+static bool expr_column(const struct buffer_event_header *header, enum filter_field_type field,
+                        int64_t *number, const char **text, size_t *len)
+{
+	switch (field) {
+	case FILTER_FIELD_INTERFACE:
+		*text = header->interface;
+		*len = strnlen(header->interface, sizeof(header->interface));
+		return true;
+	case FILTER_FIELD_NAMESPACE:
+		/* Events carry no namespace, filter_eval() sees it empty too */
+		*text = "";
+		*len = 0;
+		return true;
+	case FILTER_FIELD_EVENT_TYPE:
+		*number = header->event_type;
+		break;
+	case FILTER_FIELD_MESSAGE_TYPE:
+		*number = header->message_type;
+		break;
+	case FILTER_FIELD_TIMESTAMP:
+		*number = (int64_t)header->timestamp;
+		break;
+	case FILTER_FIELD_SEQUENCE:
+		*number = (int64_t)header->sequence;
+		break;
+	default:
+		return false;
+	}
 	
-	/* Statistics */
-	unsigned long total_added;
-	unsigned long total_overflows;
-	unsigned long peak_usage;
-};
+	*text = NULL;
+	return true;
+}
 
-struct storage_buffer *storage_buffer_create(size_t capacity)
+/* Compare a column with a literal as filter_eval() does, mismatched types never match */
+static bool expr_compare(enum filter_node_type op, int64_t number, const char *text, size_t len,
+                         const struct filter_node *literal)
 {
-	struct storage_buffer *sb;
+	int cmp;
 	
-	if (capacity == 0)
-		return NULL;
-	
-	sb = calloc(1, sizeof(*sb));
-	if (!sb)
-		return NULL;
+	if (text) {
+		size_t llen;
+		
+		if (literal->type != FILTER_NODE_STRING)
+			return false;
+		llen = strlen(literal->data.string.value);
+		cmp = memcmp(text, literal->data.string.value, len < llen ? len : llen);
+		if (cmp == 0)
+			cmp = (len > llen) - (len < llen);
+	} else {
+		if (literal->type != FILTER_NODE_NUMBER)
+			return false;
+		cmp = (number > literal->data.number.value) - (number < literal->data.number.value);
+	}
 	
-	sb->events = calloc(capacity, sizeof(struct nlmon_event));
-	if (!sb->events) {
-		free(sb);
-		return NULL;
+	switch (op) {
+	case FILTER_NODE_EQ: return cmp == 0;
+	case FILTER_NODE_NE: return cmp != 0;
+	case FILTER_NODE_LT: return cmp < 0;
+	case FILTER_NODE_GT: return cmp > 0;
+	case FILTER_NODE_LE: return cmp <= 0;
+	case FILTER_NODE_GE: return cmp >= 0;
+	default: return false;
+	}
+}
+
+/* Operator with its operands swapped, for a literal on the left */
+static enum filter_node_type expr_mirror(enum filter_node_type op)
+{
+	switch (op) {
+	case FILTER_NODE_LT: return FILTER_NODE_GT;
+	case FILTER_NODE_GT: return FILTER_NODE_LT;
+	case FILTER_NODE_LE: return FILTER_NODE_GE;
+	case FILTER_NODE_GE: return FILTER_NODE_LE;
+	default: return op;
 	}
+}
+
+/* Field and literal of a comparison of header columns, false for others */
+static bool expr_operands(const struct filter_node *node, enum filter_node_type *op,
+                          enum filter_field_type *field, const struct filter_node **literal)
+{
+	const struct filter_node *left = node->data.binary.left;
+	const struct filter_node *right = node->data.binary.right;
 	
-	sb->capacity = capacity;
-	sb->head = 0;
-	sb->count = 0;
+	*op = node->type;
+	if (left->type != FILTER_NODE_FIELD) {
+		const struct filter_node *swap = left;
+		
+		if (node->type == FILTER_NODE_IN)
+			return false;
+		left = right;
+		right = swap;
+		*op = expr_mirror(node->type);
+	}
+	if (left->type != FILTER_NODE_FIELD)
+		return false;
 	
-	if (pthread_rwlock_init(&sb->lock, NULL) != 0) {
-		free(sb->events);
-		free(sb);
-		return NULL;
+	switch (left->data.field.field) {
+	case FILTER_FIELD_INTERFACE:
+	case FILTER_FIELD_NAMESPACE:
+	case FILTER_FIELD_EVENT_TYPE:
+	case FILTER_FIELD_MESSAGE_TYPE:
+	case FILTER_FIELD_TIMESTAMP:
+	case FILTER_FIELD_SEQUENCE:
+		break;
+	default:
+		return false;
 	}
 	
-	return sb;
+	*field = left->data.field.field;
+	*literal = right;
+	if (*op == FILTER_NODE_IN)
+		return right->type == FILTER_NODE_LIST;
+	return right->type == FILTER_NODE_STRING || right->type == FILTER_NODE_NUMBER;
 }
 
-void storage_buffer_destroy(struct storage_buffer *sb)
+/* Decide expression on header, as far as its columns go */
+static enum expr_result expr_match(const struct filter_node *node,
+                                   const struct buffer_event_header *header)
 {
-	if (!sb)
-		return;
+	const struct filter_node *literal;
+	enum filter_field_type field;
+	enum filter_node_type op;
+	enum expr_result l, r;
+	const char *text;
+	int64_t number;
+	size_t len;
 	
-	pthread_rwlock_destroy(&sb->lock);
-	
-	/* Free event data */
-	for (size_t i = 0; i < sb->count; i++) {
-		size_t idx = (sb->head + sb->capacity - sb->count + i) % sb->capacity;
-		if (sb->events[idx].data)
-			free(sb->events[idx].data);
+	switch (node->type) {
+	case FILTER_NODE_AND:
+		l = expr_match(node->data.binary.left, header);
+		if (l == EXPR_FALSE)
+			return EXPR_FALSE;
+		r = expr_match(node->data.binary.right, header);
+		return r == EXPR_TRUE ? l : r;
+	case FILTER_NODE_OR:
+		l = expr_match(node->data.binary.left, header);
+		if (l == EXPR_TRUE)
+			return EXPR_TRUE;
+		r = expr_match(node->data.binary.right, header);
+		return r == EXPR_FALSE ? l : r;
+	case FILTER_NODE_NOT:
+		l = expr_match(node->data.unary.operand, header);
+		return l == EXPR_UNKNOWN ? l : (l == EXPR_TRUE ? EXPR_FALSE : EXPR_TRUE);
+	case FILTER_NODE_EQ:
+	case FILTER_NODE_NE:
+	case FILTER_NODE_LT:
+	case FILTER_NODE_GT:
+	case FILTER_NODE_LE:
+	case FILTER_NODE_GE:
+	case FILTER_NODE_IN:
+		break;
+	default:
+		/* Regular expressions are left to filter_eval() */
+		return EXPR_UNKNOWN;
 	}
 	
-	free(sb->events);
-	free(sb);
+	if (!expr_operands(node, &op, &field, &literal) ||
+	    !expr_column(header, field, &number, &text, &len))
+		return EXPR_UNKNOWN;
+	
+	if (op != FILTER_NODE_IN)
+		return expr_compare(op, number, text, len, literal) ? EXPR_TRUE : EXPR_FALSE;
+	
+	for (size_t i = 0; i < literal->data.list.count; i++) {
+		if (expr_compare(FILTER_NODE_EQ, number, text, len, literal->data.list.items[i]))
+			return EXPR_TRUE;
+	}
+	return EXPR_FALSE;
 }
 
-bool storage_buffer_add(struct storage_buffer *sb, struct nlmon_event *event)
+bool storage_buffer_expr_pushable(const struct filter_node *expr)
 {
-	if (!sb || !event)
+	const struct filter_node *literal;
+	enum filter_field_type field;
+	enum filter_node_type op;
+	
+	if (!expr)
+		return true;
+	
+	switch (expr->type) {
+	case FILTER_NODE_AND:
+	case FILTER_NODE_OR:
+		return storage_buffer_expr_pushable(expr->data.binary.left) &&
+		       storage_buffer_expr_pushable(expr->data.binary.right);
+	case FILTER_NODE_NOT:
+		return storage_buffer_expr_pushable(expr->data.unary.operand);
+	case FILTER_NODE_EQ:
+	case FILTER_NODE_NE:
+	case FILTER_NODE_LT:
+	case FILTER_NODE_GT:
+	case FILTER_NODE_LE:
+	case FILTER_NODE_GE:
+	case FILTER_NODE_IN:
+		return expr_operands(expr, &op, &field, &literal);
+	default:
 		return false;
+	}
+}
+
+bool storage_buffer_header_match(const struct filter_node *expr,
+                                 const struct buffer_event_header *header)
+{
+	return !expr || !header || expr_match(expr, header) != EXPR_FALSE;
+}
+
+/* Query filter resolved against the interned keys */
+struct query_plan {
+	struct buffer_query_filter *filter;
+	uint64_t atoms[MAX_ATOMS / 64];   /* Atoms matching the interface pattern */
+	uint64_t atom_bits;               /* KEY_BIT of those, for block summaries */
+	unsigned num_atoms;
+	uint16_t atom;                    /* The matching atom if num_atoms is 1 */
+	bool atoms_complete;              /* No interface without atom can match */
+	uint16_t type_key;
+	int row_flags;                    /* Columns a matching row is loaded with */
+};
+
+/* Resolve filter, false if no stored event can match it */
+static bool query_plan_init(struct storage_buffer *sb, struct query_plan *plan,
+                            struct buffer_query_filter *filter)
+{
+	memset(plan, 0, sizeof(*plan));
+	plan->filter = filter;
+	plan->atom = KEY_NONE;
+	plan->type_key = KEY_NONE;
+	plan->row_flags = ROW_EVENT;
+	
+	if (!filter)
+		return true;
 	
-	pthread_rwlock_wrlock(&sb->lock);
+	/* The expression compares the sequence and names of interfaces with atoms too */
+	if (filter->expr)
+		plan->row_flags |= ROW_HEADER;
 	
-	/* If buffer is full, free the oldest event's data */
-	if (sb->count == sb->capacity) {
-		size_t oldest_idx = (sb->head + sb->capacity - sb->count) % sb->capacity;
-		if (sb->events[oldest_idx].data) {
-			free(sb->events[oldest_idx].data);
-			sb->events[oldest_idx].data = NULL;
+	/* Match the pattern once per interface rather than once per event */
+	if (filter->interface_pattern) {
+		unsigned count = atomic_load_explicit(&sb->num_atoms, memory_order_acquire);
+		char name[17];
+		
+		for (unsigned i = 0; i < count; i++) {
+			uint64_t words[2] = {
+				atomic_load_explicit(&sb->atom_names[i][0], memory_order_relaxed),
+				atomic_load_explicit(&sb->atom_names[i][1], memory_order_relaxed)
+			};
+			
+			memcpy(name, words, 16);
+			name[16] = '\0';
+			if (fnmatch(filter->interface_pattern, name, 0) != 0)
+				continue;
+			
+			plan->atoms[i / 64] |= 1ULL << (i % 64);
+			plan->atom_bits |= KEY_BIT(i);
+			plan->atom = (uint16_t)i;
+			plan->num_atoms++;
 		}
-		sb->total_overflows++;
-	} else {
-		sb->count++;
+		
+		/* A pattern without wildcards names an interface with an atom */
+		plan->atoms_complete = !atomic_load_explicit(&sb->atoms_full, memory_order_relaxed) ||
+		                       (plan->num_atoms == 1 &&
+		                        !strpbrk(filter->interface_pattern, "*?[\\"));
+		if (!plan->atoms_complete)
+			plan->atom_bits |= KEY_BIT(KEY_NONE);
+		else if (plan->num_atoms == 0)
+			return false;
+	}
+	
+	if (filter->event_type != 0) {
+		plan->type_key = type_lookup(sb, filter->event_type);
+		if (plan->type_key == KEY_NONE &&
+		    !atomic_load_explicit(&sb->types_full, memory_order_relaxed))
+			return false;
 	}
 	
-	/* Copy event */
-	sb->events[sb->head] = *event;
+	return true;
+}
+
+/* Helper function to check if event matches filter */
+static bool event_matches_filter(const struct storage_row *row, const struct query_plan *plan)
+{
+	struct buffer_query_filter *filter = plan->filter;
+	
+	if (!filter)
+		return true;
 	
-	/* Deep copy event data if present */
-	if (event->data && event->data_size > 0) {
-		sb->events[sb->head].data = malloc(event->data_size);
-		if (sb->events[sb->head].data) {
-			memcpy(sb->events[sb->head].data, event->data, event->data_size);
+	/* Check interface pattern */
+	if (filter->interface_pattern) {
+		if (row->atom != KEY_NONE) {
+			if (!(plan->atoms[row->atom / 64] & (1ULL << (row->atom % 64))))
+				return false;
+		} else {
+			char interface[17];
+			
+			memcpy(interface, row->interface, 16);
+			interface[16] = '\0';
+			if (fnmatch(filter->interface_pattern, interface, 0) != 0)
+				return false;
 		}
-	} else {
-		sb->events[sb->head].data = NULL;
 	}
 	
-	/* Advance head */
-	sb->head = (sb->head + 1) % sb->capacity;
+	/* Check event type */
+	if (filter->event_type != 0 && row->event_type != filter->event_type)
+		return false;
 	
-	/* Update statistics */
-	sb->total_added++;
-	if (sb->count > sb->peak_usage)
-		sb->peak_usage = sb->count;
+	/* Check message type */
+	if (filter->message_type != 0 && row->message_type != filter->message_type)
+		return false;
+	
+	/* Check time range */
+	if (filter->start_time != 0 && row->timestamp < filter->start_time)
+		return false;
+	
+	if (filter->end_time != 0 && row->timestamp > filter->end_time)
+		return false;
 	
-	pthread_rwlock_unlock(&sb->lock);
+	/* Then the expression, on the same columns */
+	if (filter->expr) {
+		struct buffer_event_header header;
+		
+		row_header(&header, row);
+		if (expr_match(filter->expr, &header) == EXPR_FALSE)
+			return false;
+	}
 	
 	return true;
 }
 
-bool storage_buffer_get(struct storage_buffer *sb, size_t index,
-                        struct nlmon_event *event)
+/* Whether a summary of rows rules out all of them */
+static bool summary_skip(const struct query_plan *plan, uint64_t min_ts, uint64_t max_ts,
+                         uint64_t atoms, uint64_t types, uint32_t min_mt, uint32_t max_mt)
 {
-	bool found = false;
+	struct buffer_query_filter *filter = plan->filter;
 	
-	if (!sb || !event)
+	if (!filter)
 		return false;
 	
-	pthread_rwlock_rdlock(&sb->lock);
+	if (filter->start_time != 0 && max_ts < filter->start_time)
+		return true;
+	if (filter->end_time != 0 && min_ts > filter->end_time)
+		return true;
+	if (filter->message_type != 0 &&
+	    (filter->message_type < min_mt || filter->message_type > max_mt))
+		return true;
+	if (filter->interface_pattern && !(atoms & plan->atom_bits))
+		return true;
+	if (filter->event_type != 0 && !(types & KEY_BIT(plan->type_key)))
+		return true;
 	
-	if (index < sb->count) {
-		size_t actual_idx = (sb->head + sb->capacity - sb->count + index) % sb->capacity;
-		*event = sb->events[actual_idx];
-		
-		/* Deep copy event data */
-		if (sb->events[actual_idx].data && sb->events[actual_idx].data_size > 0) {
-			event->data = malloc(sb->events[actual_idx].data_size);
-			if (event->data) {
-				memcpy(event->data, sb->events[actual_idx].data,
-				       sb->events[actual_idx].data_size);
-			}
+	return false;
+}
+
+/* Whether the summary of block rules out all of its rows */
+static bool block_skip(struct storage_buffer *sb, uint64_t block, const struct query_plan *plan)
+{
+	struct buffer_query_filter *filter = plan->filter;
+	struct block_summary *s = &sb->blocks[block % sb->num_blocks];
+	uint64_t tag, min_ts, max_ts, atoms, types;
+	uint32_t min_mt, max_mt;
+	unsigned seq;
+	
+	if (!filter)
+		return false;
+	
+	for (;;) {
+		seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+		if (seq & 1) {
+			sched_yield();
+			continue;
 		}
 		
-		found = true;
+		tag = atomic_load_explicit(&s->block, memory_order_relaxed);
+		min_ts = atomic_load_explicit(&s->min_timestamp, memory_order_relaxed);
+		max_ts = atomic_load_explicit(&s->max_timestamp, memory_order_relaxed);
+		atoms = atomic_load_explicit(&s->atoms, memory_order_relaxed);
+		types = atomic_load_explicit(&s->types, memory_order_relaxed);
+		min_mt = atomic_load_explicit(&s->min_message_type, memory_order_relaxed);
+		max_mt = atomic_load_explicit(&s->max_message_type, memory_order_relaxed);
+		
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&s->seq, memory_order_relaxed) == seq)
+			break;
 	}
 	
-	pthread_rwlock_unlock(&sb->lock);
+	/* Entry reused by a newer block, the rows are checked one by one */
+	if (tag != block + 1)
+		return false;
 	
-	return found;
+	return summary_skip(plan, min_ts, max_ts, atoms, types, min_mt, max_mt);
 }
 
-size_t storage_buffer_get_latest(struct storage_buffer *sb, size_t count,
-                                 struct nlmon_event *events)
+/* Report the matches in [tail, head), skipping blocks ruled out */
+static size_t query_scan(struct storage_buffer *sb, const struct query_plan *plan,
+                         uint64_t tail, uint64_t head, size_t max_results,
+                         buffer_query_callback_t callback, void *ctx)
 {
-	size_t retrieved = 0;
-	
-	if (!sb || !events)
-		return 0;
-	
-	pthread_rwlock_rdlock(&sb->lock);
-	
-	size_t to_retrieve = (count < sb->count) ? count : sb->count;
+	struct storage_row row;
+	size_t matches = 0;
+	uint64_t pos = tail;
 	
-	for (size_t i = 0; i < to_retrieve; i++) {
-		/* Get from newest to oldest */
-		size_t idx = (sb->head + sb->capacity - 1 - i) % sb->capacity;
-		events[i] = sb->events[idx];
+	while (pos < head && matches < max_results) {
+		uint64_t block = pos >> BLOCK_SHIFT;
+		uint64_t end = (block + 1) << BLOCK_SHIFT;
 		
-		/* Deep copy event data */
-		if (sb->events[idx].data && sb->events[idx].data_size > 0) {
-			events[i].data = malloc(sb->events[idx].data_size);
-			if (events[i].data) {
-				memcpy(events[i].data, sb->events[idx].data,
-				       sb->events[idx].data_size);
-			}
+		if (end > head)
+			end = head;
+		
+		if (block_skip(sb, block, plan)) {
+			pos = end;
+			continue;
 		}
 		
-		retrieved++;
+		for (; pos < end && matches < max_results; pos++) {
+			if (!row_load(sb, pos, plan->row_flags, &row)) {
+				/* Evicted meanwhile, continue with the oldest still stored */
+				uint64_t oldest = atomic_load_explicit(&sb->tail, memory_order_acquire);
+				
+				if (oldest > pos + 1)
+					pos = oldest - 1;
+				continue;
+			}
+			
+			if (event_matches_filter(&row, plan)) {
+				callback(row.event, ctx);
+				matches++;
+			}
+		}
 	}
 	
-	pthread_rwlock_unlock(&sb->lock);
-	
-	return retrieved;
+	return matches;
 }
 
-/* Helper function to check if event matches filter */
-static bool event_matches_filter(struct nlmon_event *event,
-                                 struct buffer_query_filter *filter)
+/* Decode the next event of a history block, false if the encoding ends */
+static bool history_decode(struct storage_buffer *sb, const uint8_t **p, const uint8_t *end,
+                           uint64_t *timestamp, uint64_t *sequence,
+                           struct storage_row *row, struct nlmon_event *event)
 {
-	if (!filter)
-		return true;
+	uint64_t v[16];
 	
-	/* Check interface pattern */
-	if (filter->interface_pattern) {
-		if (fnmatch(filter->interface_pattern, event->interface, 0) != 0)
+	for (int i = 0; i < 5; i++) {
+		if (!get_varint(p, end, &v[i]))
 			return false;
 	}
 	
-	/* Check event type */
-	if (filter->event_type != 0 && event->event_type != filter->event_type)
-		return false;
+	memset(event, 0, sizeof(*event));
+	*timestamp += unzigzag(v[0]);
+	*sequence += unzigzag(v[1]);
+	event->timestamp = *timestamp;
+	event->sequence = *sequence;
+	event->event_type = (uint32_t)v[2];
+	event->message_type = (uint16_t)v[3];
 	
-	/* Check message type */
-	if (filter->message_type != 0 && event->message_type != filter->message_type)
-		return false;
+	row->atom = (uint16_t)v[4];
+	if (row->atom == KEY_NONE) {
+		if ((size_t)(end - *p) < sizeof(event->interface))
+			return false;
+		memcpy(event->interface, *p, sizeof(event->interface));
+		*p += sizeof(event->interface);
+	} else {
+		uint64_t name[2] = {
+			atomic_load_explicit(&sb->atom_names[row->atom][0], memory_order_relaxed),
+			atomic_load_explicit(&sb->atom_names[row->atom][1], memory_order_relaxed)
+		};
+		
+		memcpy(event->interface, name, sizeof(event->interface));
+	}
 	
-	/* Check time range */
-	if (filter->start_time != 0 && event->timestamp < filter->start_time)
+	for (int i = 5; i < 15; i++) {
+		if (!get_varint(p, end, &v[i]))
+			return false;
+	}
+	if (v[14] > sizeof(event->netlink.genl_family_name) || (uint64_t)(end - *p) < v[14])
 		return false;
+	event->netlink.protocol = (int)(int64_t)unzigzag(v[5]);
+	event->netlink.msg_type = (uint16_t)v[6];
+	event->netlink.msg_flags = (uint16_t)v[7];
+	event->netlink.seq = (uint32_t)v[8];
+	event->netlink.pid = (uint32_t)v[9];
+	event->netlink.netns = v[10];
+	event->netlink.genl_cmd = (uint8_t)v[11];
+	event->netlink.genl_version = (uint8_t)v[12];
+	event->netlink.genl_family_id = (uint16_t)v[13];
+	memcpy(event->netlink.genl_family_name, *p, v[14]);
+	*p += v[14];
 	
-	if (filter->end_time != 0 && event->timestamp > filter->end_time)
+	/* The data stays in the decoded block */
+	if (!get_varint(p, end, &v[15]) || (uint64_t)(end - *p) < v[15])
 		return false;
+	event->data = v[15] ? (void *)*p : NULL;
+	event->data_size = v[15];
+	*p += v[15];
+	
+	row->timestamp = event->timestamp;
+	row->sequence = event->sequence;
+	row->event_type = event->event_type;
+	row->message_type = event->message_type;
+	memcpy(row->interface, event->interface, sizeof(row->interface));
 	
 	return true;
 }
 
+/* Whether the summary of a history block rules out all of its events */
+static bool history_skip(const struct history_block *block, const struct query_plan *plan)
+{
+	return summary_skip(plan, block->min_timestamp, block->max_timestamp, block->atoms,
+	                    block->types, block->min_message_type, block->max_message_type);
+}
+
+/* Report the matches among the history events before tail, oldest first */
+static size_t query_history(struct storage_buffer *sb, const struct query_plan *plan,
+                            uint64_t tail, size_t max_results,
+                            buffer_query_callback_t callback, void *ctx)
+{
+	struct history_block **blocks = NULL;
+	struct nlmon_event event;
+	struct storage_row row;
+	uint8_t *raw = NULL;
+	size_t count, raw_size = 0, matches = 0;
+	
+	/* Take references, blocks dropped meanwhile stay readable */
+	pthread_mutex_lock(&sb->history_lock);
+	count = sb->history_count;
+	if (count)
+		blocks = malloc(count * sizeof(*blocks));
+	if (blocks) {
+		for (size_t i = 0; i < count; i++) {
+			blocks[i] = sb->history[i];
+			atomic_fetch_add_explicit(&blocks[i]->refs, 1, memory_order_relaxed);
+		}
+	} else {
+		count = 0;
+	}
+	pthread_mutex_unlock(&sb->history_lock);
+	
+	for (size_t i = 0; i < count; i++) {
+		struct history_block *block = blocks[i];
+		uint64_t timestamp = 0, sequence = 0, pos = block->first;
+		const uint8_t *p, *end;
+		uLongf size = block->raw_size;
+		
+		if (matches == max_results || block->first >= tail || history_skip(block, plan))
+			goto next;
+		
+		/* Inflate only the blocks that may hold a match */
+		if (raw_size < block->raw_size) {
+			uint8_t *grown = realloc(raw, block->raw_size);
+			
+			if (!grown)
+				goto next;
+			raw = grown;
+			raw_size = block->raw_size;
+		}
+		if (uncompress(raw, &size, block->data, block->size) != Z_OK)
+			goto next;
+		
+		p = raw;
+		end = raw + size;
+		for (; pos < block->first + block->count && pos < tail && matches < max_results; pos++) {
+			if (!history_decode(sb, &p, end, &timestamp, &sequence, &row, &event))
+				break;
+			if (event_matches_filter(&row, plan)) {
+				callback(&event, ctx);
+				matches++;
+			}
+		}
+	
+next:
+		history_put(block);
+	}
+	
+	free(raw);
+	free(blocks);
+	
+	return matches;
+}
+
+/* Report the matches among the rows chained to one key */
+static size_t query_chain(struct storage_buffer *sb, const struct query_plan *plan,
+                          struct posting *posting, bool by_atom, uint64_t head,
+                          size_t max_results, buffer_query_callback_t callback, void *ctx)
+{
+	struct storage_row row;
+	size_t matches = 0;
+	uint64_t next = atomic_load_explicit(&posting->first, memory_order_relaxed);
+	
+	while (next != 0 && next - 1 < head && matches < max_results) {
+		uint64_t pos = next - 1;
+		
+		if (!row_load(sb, pos, plan->row_flags | ROW_LINKS, &row)) {
+			/* Evicted meanwhile, the chain now starts later */
+			next = atomic_load_explicit(&posting->first, memory_order_relaxed);
+			if (next != 0 && next - 1 <= pos)
+				break;
+			continue;
+		}
+		
+		if (event_matches_filter(&row, plan)) {
+			callback(row.event, ctx);
+			matches++;
+		}
+		next = by_atom ? row.next_atom : row.next_type;
+	}
+	
+	return matches;
+}
+
 size_t storage_buffer_query(struct storage_buffer *sb,
                             struct buffer_query_filter *filter,
                             buffer_query_callback_t callback,
                             void *ctx)
 {
-	size_t matches = 0;
+	struct posting *posting = NULL;
+	struct query_plan plan;
+	size_t matches = 0, max_results;
+	uint64_t tail, head;
+	bool by_atom = false;
+	unsigned idx;
 	
 	if (!sb || !callback)
 		return 0;
 	
-	pthread_rwlock_rdlock(&sb->lock);
+	idx = read_lock(sb);
 	
-	size_t max_results = filter && filter->max_results > 0 ? 
-	                     filter->max_results : sb->count;
+	/* Keys, summaries and chains read from here on cover all before head */
+	buffer_range(sb, &tail, &head);
+	max_results = filter && filter->max_results > 0 ? filter->max_results : SIZE_MAX;
 	
-	/* Iterate from oldest to newest */
-	for (size_t i = 0; i < sb->count && matches < max_results; i++) {
-		size_t idx = (sb->head + sb->capacity - sb->count + i) % sb->capacity;
+	if (!query_plan_init(sb, &plan, filter))
+		goto out;
+	
+	/* Events sealed into the history are older than any in the buffer */
+	if (atomic_load_explicit(&sb->history_bytes, memory_order_relaxed)) {
+		matches = query_history(sb, &plan, tail, max_results, callback, ctx);
+		max_results -= matches;
+		if (max_results == 0)
+			goto out;
+	}
+	
+	/* Follow the shorter chain of a key every match carries */
+	if (sb->atom_postings) {
+		uint64_t best = UINT64_MAX;
 		
-		if (event_matches_filter(&sb->events[idx], filter)) {
-			callback(&sb->events[idx], ctx);
-			matches++;
+		if (plan.num_atoms == 1 && plan.atoms_complete) {
+			posting = &sb->atom_postings[plan.atom];
+			best = atomic_load_explicit(&posting->count, memory_order_relaxed);
+			by_atom = true;
+		}
+		if (plan.type_key != KEY_NONE &&
+		    atomic_load_explicit(&sb->type_postings[plan.type_key].count,
+		                         memory_order_relaxed) < best) {
+			posting = &sb->type_postings[plan.type_key];
+			by_atom = false;
 		}
 	}
 	
-	pthread_rwlock_unlock(&sb->lock);
+	if (posting)
+		matches += query_chain(sb, &plan, posting, by_atom, head, max_results, callback, ctx);
+	else
+		matches += query_scan(sb, &plan, tail, head, max_results, callback, ctx);
+	
+out:
+	read_unlock(sb, idx);
 	
 	return matches;
 }
 
 size_t storage_buffer_size(struct storage_buffer *sb)
 {
-	size_t size;
+	uint64_t tail, head;
 	
 	if (!sb)
 		return 0;
 	
-	pthread_rwlock_rdlock(&sb->lock);
-	size = sb->count;
-	pthread_rwlock_unlock(&sb->lock);
+	buffer_range(sb, &tail, &head);
 	
-	return size;
+	return (size_t)(head - tail);
 }
 
 size_t storage_buffer_capacity(struct storage_buffer *sb)
@@ -268,24 +1913,46 @@ size_t storage_buffer_capacity(struct storage_buffer *sb)
 
 void storage_buffer_clear(struct storage_buffer *sb)
 {
+	uint64_t tail, head;
+	
 	if (!sb)
 		return;
 	
-	pthread_rwlock_wrlock(&sb->lock);
+	pthread_mutex_lock(&sb->write_lock);
 	
-	/* Free all event data */
-	for (size_t i = 0; i < sb->count; i++) {
-		size_t idx = (sb->head + sb->capacity - sb->count + i) % sb->capacity;
-		if (sb->events[idx].data) {
-			free(sb->events[idx].data);
-			sb->events[idx].data = NULL;
+	tail = atomic_load_explicit(&sb->tail, memory_order_relaxed);
+	head = atomic_load_explicit(&sb->head, memory_order_relaxed);
+	
+	/* Empty the chains, appends start them anew once the tail moved */
+	if (sb->atom_postings) {
+		for (size_t i = 0; i < MAX_ATOMS; i++) {
+			atomic_store_explicit(&sb->atom_postings[i].first, 0, memory_order_relaxed);
+			atomic_store_explicit(&sb->atom_postings[i].count, 0, memory_order_relaxed);
+		}
+		for (size_t i = 0; i < MAX_TYPES; i++) {
+			atomic_store_explicit(&sb->type_postings[i].first, 0, memory_order_relaxed);
+			atomic_store_explicit(&sb->type_postings[i].count, 0, memory_order_relaxed);
 		}
 	}
+	atomic_store_explicit(&sb->tail, head, memory_order_release);
+	
+	/* Retire all event references */
+	for (uint64_t pos = tail; pos < head; pos++) {
+		size_t row = pos % sb->capacity;
+		struct nlmon_event *event = atomic_load_explicit(&sb->cols.event[row],
+		                                                 memory_order_relaxed);
+		
+		row_store(sb, row, pos, NULL, KEY_NONE, KEY_NONE);
+		if (event)
+			retire(sb, event);
+	}
+	reclaim(sb);
 	
-	sb->head = 0;
-	sb->count = 0;
+	/* The history goes too, sealing resumes with the next events */
+	history_trim(sb, 0);
+	sb->history_next = head;
 	
-	pthread_rwlock_unlock(&sb->lock);
+	pthread_mutex_unlock(&sb->write_lock);
 }
 
 void storage_buffer_stats(struct storage_buffer *sb,
@@ -296,14 +1963,137 @@ void storage_buffer_stats(struct storage_buffer *sb,
 	if (!sb)
 		return;
 	
-	pthread_rwlock_rdlock(&sb->lock);
-	
 	if (total_added)
-		*total_added = sb->total_added;
+		*total_added = atomic_load_explicit(&sb->total_added, memory_order_relaxed);
 	if (total_overflows)
-		*total_overflows = sb->total_overflows;
+		*total_overflows = atomic_load_explicit(&sb->total_overflows, memory_order_relaxed);
 	if (peak_usage)
-		*peak_usage = sb->peak_usage;
+		*peak_usage = atomic_load_explicit(&sb->peak_usage, memory_order_relaxed);
+}
+
+void storage_buffer_set_limit(struct storage_buffer *sb, size_t max_events)
+{
+	uint64_t tail, head;
+	
+	if (!sb)
+		return;
+	
+	if (max_events >= sb->capacity)
+		max_events = 0;
+	
+	pthread_mutex_lock(&sb->write_lock);
+	
+	atomic_store_explicit(&sb->limit, max_events, memory_order_relaxed);
+	if (max_events) {
+		tail = atomic_load_explicit(&sb->tail, memory_order_relaxed);
+		head = atomic_load_explicit(&sb->head, memory_order_relaxed);
+		while (head - tail > max_events)
+			evict_oldest(sb, tail++);
+		reclaim(sb);
+	}
+	
+	pthread_mutex_unlock(&sb->write_lock);
+}
+
+size_t storage_buffer_limit(struct storage_buffer *sb)
+{
+	size_t limit;
+	
+	if (!sb)
+		return 0;
+	
+	limit = atomic_load_explicit(&sb->limit, memory_order_relaxed);
+	return limit ? limit : sb->capacity;
+}
+
+size_t storage_buffer_memory(struct storage_buffer *sb)
+{
+	if (!sb)
+		return 0;
+	
+	return sb->fixed_bytes + atomic_load_explicit(&sb->event_bytes, memory_order_relaxed) +
+	       atomic_load_explicit(&sb->history_bytes, memory_order_relaxed);
+}
+
+size_t storage_buffer_memory_usage(void *ctx)
+{
+	return storage_buffer_memory(ctx);
+}
+
+/* Keep the history within cap bytes, at most the configured ones */
+static void history_limit(struct storage_buffer *sb, size_t cap)
+{
+	pthread_mutex_lock(&sb->write_lock);
+	
+	if (cap > sb->history_max)
+		cap = sb->history_max;
+	atomic_store_explicit(&sb->history_cap, cap, memory_order_relaxed);
+	if (sb->history_max)
+		history_trim(sb, cap);
+	
+	pthread_mutex_unlock(&sb->write_lock);
+}
+
+void storage_buffer_memory_respond(void *ctx, enum memory_pressure level, size_t target)
+{
+	struct storage_buffer *sb = ctx;
+	size_t held, events, per_event;
+	
+	if (!sb)
+		return;
+	
+	/* Low pressure has nothing to trim, events are the whole of it */
+	if (level < MEMORY_PRESSURE_HIGH || target == 0) {
+		storage_buffer_set_limit(sb, 0);
+		history_limit(sb, SIZE_MAX);
+		return;
+	}
+	
+	/* The history keeps a quarter of the target at most, the rest is for events */
+	history_limit(sb, target / 4);
+	target -= atomic_load_explicit(&sb->history_bytes, memory_order_relaxed);
+	
+	/* Keep as many events as fit the target at their current mean size */
+	held = atomic_load_explicit(&sb->event_bytes, memory_order_relaxed);
+	events = storage_buffer_size(sb);
+	per_event = events && held ? held / events : sizeof(struct nlmon_event);
+	if (target <= sb->fixed_bytes + per_event)
+		events = 1;
+	else
+		events = (target - sb->fixed_bytes) / per_event;
+	
+	storage_buffer_set_limit(sb, events);
+}
+
+void storage_buffer_set_history(struct storage_buffer *sb, size_t max_bytes)
+{
+	if (!sb)
+		return;
+	
+	pthread_mutex_lock(&sb->write_lock);
+	
+	/* Seal only what is evicted from now on */
+	if (!sb->history_max)
+		sb->history_next = atomic_load_explicit(&sb->tail, memory_order_relaxed);
+	sb->history_max = max_bytes;
+	atomic_store_explicit(&sb->history_cap, max_bytes, memory_order_relaxed);
+	history_trim(sb, max_bytes);
+	
+	pthread_mutex_unlock(&sb->write_lock);
+}
+
+void storage_buffer_history_stats(struct storage_buffer *sb, struct buffer_history_stats *stats)
+{
+	if (!sb || !stats)
+		return;
+	
+	pthread_mutex_lock(&sb->history_lock);
+	
+	stats->blocks = sb->history_count;
+	stats->events = atomic_load_explicit(&sb->history_events, memory_order_relaxed);
+	stats->bytes = atomic_load_explicit(&sb->history_bytes, memory_order_relaxed);
+	stats->raw_bytes = atomic_load_explicit(&sb->history_raw, memory_order_relaxed);
+	stats->max_bytes = atomic_load_explicit(&sb->history_cap, memory_order_relaxed);
 	
-	pthread_rwlock_unlock(&sb->lock);
+	pthread_mutex_unlock(&sb->history_lock);
 }
@@ -2,6 +2,21 @@
  *
  * Implements persistent storage for network events using SQLite with
  * batched inserts, indexing, and query optimization.
+ *
+ * The async writer takes events from a lock-free MPMC ring and inserts
+ * them in one transaction, committed once it holds the batcher's size
+ * or its linger time after it began, whichever comes first. Both adapt
+ * to the commit latency up to commit_count and commit_interval_ms, so a
+ * lightly loaded writer commits as soon as the ring drains. The
+ * connection lock keeps callers' queries and maintenance from running
+ * while the writer is inside SQLite. Flushes queue a marker behind the
+ * caller's events and wait until the writer has committed up to it.
+ *
+ * Partition tables are named events_p<n> and hold the timestamps of
+ * [n * span, (n + 1) * span). Events of the unpartitioned table predate
+ * partitioning and are treated as older than all partitions. New
+ * partitioned databases use incremental auto-vacuum, so the pages of
+ * dropped tables are returned to the file system without a VACUUM.
  */
 
 #include <stdlib.h>
@@ -9,15 +24,68 @@
 #include <stdio.h>
 #include <sqlite3.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <stdarg.h>
 #include "storage_db.h"
+#include "filter_parser.h"
 #include "event_processor.h"
+#include "ring_buffer.h"
+#include "nlmon_probes.h"
+#include "pipeline_watchdog.h"
+#include "adaptive_batch.h"
 
 /* Database schema version */
-#define SCHEMA_VERSION 1
+#define SCHEMA_VERSION 2
 
 /* Default batch size */
 #define DEFAULT_BATCH_SIZE 100
 
+/* Async writer defaults */
+#define DEFAULT_QUEUE_SIZE 65536
+#define DEFAULT_COMMIT_COUNT 5000
+#define DEFAULT_COMMIT_INTERVAL_MS 50
+
+/* Events the writer inserts per hold of the connection lock */
+#define WRITER_CHUNK 256
+
+/* Longest writer sleep with no transaction open */
+#define WRITER_IDLE_MS 1000
+
+/* Prepared query statements kept, by SQL text */
+#define STMT_CACHE_SIZE 64
+
+/* Most parameters and SQL of a filter expression pushed into a query */
+#define EXPR_MAX_PARAMS 32
+#define EXPR_SQL_MAX 512
+
+/* Most parameters of one query */
+#define QUERY_MAX_PARAMS (12 + EXPR_MAX_PARAMS)
+
+/* Longest WHERE clause and query on one table */
+#define WHERE_MAX (512 + EXPR_SQL_MAX)
+#define QUERY_SQL_MAX (1024 + EXPR_SQL_MAX)
+
+/* Columns of an event table */
+#define EVENT_COLUMNS "timestamp, sequence, event_type, message_type, interface, namespace, details, " \
+                      "sample_weight"
+
+/* Partition table of timestamps [id * span, (id + 1) * span) */
+struct db_partition {
+	uint64_t id;
+	sqlite3_stmt *insert_stmt;      /* Prepared on the first insert */
+};
+
+/* Prepared query, unused slots have no sql */
+struct db_cached_stmt {
+	char *sql;
+	sqlite3_stmt *stmt;
+	uint64_t used;                  /* Clock of the last use, for eviction */
+};
+
 /* Database structure */
 struct storage_db {
 	sqlite3 *db;
@@ -25,8 +93,50 @@ struct storage_db {
 	size_t batch_size;
 	size_t batch_count;
 	bool in_transaction;
+	uint64_t batch_begin_ns;        /* Async: when the open transaction began */
+	uint64_t batch_deadline_ns;     /* Async: commit time of the open transaction */
+	pthread_mutex_t lock;           /* Serializes use of the connection */
+	
+	/* Partitions, sorted by id, guarded by lock */
+	uint64_t partition_span;        /* 0 if not partitioned */
+	struct db_partition *partitions;
+	size_t num_partitions;
+	size_t max_partitions;
+	size_t last_partition;          /* Index of the last partition inserted into */
+	bool incremental_vacuum;        /* auto_vacuum is INCREMENTAL */
+	
+	/* Query statements, guarded by lock */
+	struct db_cached_stmt stmt_cache[STMT_CACHE_SIZE];
+	uint64_t stmt_clock;
+	
+	/* Async writer, queue is NULL if inserts run on the caller */
+	struct ring_buffer *queue;
+	pthread_t writer;
+	atomic_bool running;
+	atomic_bool parked;
+	pthread_mutex_t wake_lock;
+	pthread_cond_t wake;            /* Signalled while the writer is parked */
+	pthread_cond_t flushed;
+	pthread_mutex_t flush_lock;     /* Orders flush markers by ticket */
+	uint64_t flush_requested;       /* Tickets taken, guarded by flush_lock */
+	uint64_t flush_done;            /* Markers committed, guarded by wake_lock */
+	bool flush_ok;                  /* Whether the last of them committed */
+	struct adaptive_batch *batcher; /* Commit size and linger of the writer */
+	
+	/* Writer statistics */
+	atomic_ullong queued;
+	atomic_ullong dropped;
+	atomic_ullong committed;
+	atomic_ullong failed;
+	atomic_ullong commits;
+	atomic_ullong commit_latency_max_us;
+	atomic_ullong commit_latency_us[STORAGE_DB_HIST_BUCKETS];
+	atomic_ullong queue_depth_hist[STORAGE_DB_HIST_BUCKETS];
 };
 
+/* Queued after the events a flush waits for, never inserted */
+static struct nlmon_event flush_marker;
+
 /* Database schema */
 static const char *schema_sql = 
 	"CREATE TABLE IF NOT EXISTS events ("
@@ -37,22 +147,73 @@ static const char *schema_sql =
 	"  message_type INTEGER NOT NULL,"
 	"  interface TEXT,"
 	"  namespace TEXT,"
-	"  details BLOB"
+	"  details BLOB,"
+	"  sample_weight INTEGER NOT NULL DEFAULT 1"
 	");"
 	"CREATE INDEX IF NOT EXISTS idx_timestamp ON events(timestamp);"
-	"CREATE INDEX IF NOT EXISTS idx_event_type ON events(event_type);"
-	"CREATE INDEX IF NOT EXISTS idx_interface ON events(interface);"
+	"CREATE INDEX IF NOT EXISTS idx_event_type_timestamp ON events(event_type, timestamp);"
+	"CREATE INDEX IF NOT EXISTS idx_interface_timestamp ON events(interface, timestamp);"
 	"CREATE INDEX IF NOT EXISTS idx_namespace ON events(namespace);"
+	"DROP INDEX IF EXISTS idx_event_type;"
+	"DROP INDEX IF EXISTS idx_interface;"
 	"CREATE TABLE IF NOT EXISTS metadata ("
 	"  key TEXT PRIMARY KEY,"
 	"  value TEXT"
 	");"
-	"INSERT OR REPLACE INTO metadata (key, value) VALUES ('schema_version', '1');";
+	"INSERT OR REPLACE INTO metadata (key, value) VALUES ('schema_version', '3');";
+
+/* Event table of an older schema, without the sample_weight column */
+static const char *unmigrated_sql =
+	"SELECT name FROM sqlite_master AS t WHERE type = 'table' AND "
+	"(name = 'events' OR name GLOB 'events_p[0-9]*') AND NOT EXISTS "
+	"(SELECT 1 FROM pragma_table_info(t.name) WHERE name = 'sample_weight') LIMIT 1";
 
 /* Prepared statement SQL */
 static const char *insert_sql =
 	"INSERT INTO events (timestamp, sequence, event_type, message_type, "
-	"interface, namespace, details) VALUES (?, ?, ?, ?, ?, ?, ?)";
+	"interface, namespace, details, sample_weight) VALUES (?, ?, ?, ?, ?, ?, ?, ?)";
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Histogram bucket of value, by its bit length */
+static size_t hist_bucket(uint64_t value)
+{
+	size_t bucket = value ? 64 - (size_t)__builtin_clzll(value) : 0;
+	
+	return bucket < STORAGE_DB_HIST_BUCKETS ? bucket : STORAGE_DB_HIST_BUCKETS - 1;
+}
+
+/* Add sample_weight to the event tables of schema 2, events of before were all kept */
+static bool migrate_schema(sqlite3 *db)
+{
+	sqlite3_stmt *stmt;
+	char sql[128];
+	int rc;
+	
+	for (;;) {
+		if (sqlite3_prepare_v2(db, unmigrated_sql, -1, &stmt, NULL) != SQLITE_OK)
+			break;
+		rc = sqlite3_step(stmt);
+		if (rc == SQLITE_ROW)
+			snprintf(sql, sizeof(sql),
+			         "ALTER TABLE \"%s\" ADD COLUMN sample_weight INTEGER NOT NULL DEFAULT 1",
+			         (const char *)sqlite3_column_text(stmt, 0));
+		sqlite3_finalize(stmt);
+		if (rc == SQLITE_DONE)
+			return true;
+		if (rc != SQLITE_ROW || sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK)
+			break;
+	}
+	
+	fprintf(stderr, "Failed to migrate schema: %s\n", sqlite3_errmsg(db));
+	return false;
+}
 
 /* Initialize database schema */
 static bool init_schema(sqlite3 *db)
@@ -67,7 +228,7 @@ static bool init_schema(sqlite3 *db)
 		return false;
 	}
 	
-	return true;
+	return migrate_schema(db);
 }
 
 /* Configure database for performance */
@@ -98,6 +259,11 @@ static bool configure_db(sqlite3 *db, struct storage_db_config *config)
 		}
 	}
 	
+	/* Leave WAL checkpoints to storage_db_wal_checkpoint() */
+	if (config->wal_autocheckpoint != 0)
+		sqlite3_wal_autocheckpoint(db, config->wal_autocheckpoint > 0 ?
+		                           config->wal_autocheckpoint : 0);
+	
 	/* Set busy timeout */
 	if (config->busy_timeout_ms > 0) {
 		rc = sqlite3_busy_timeout(db, config->busy_timeout_ms);
@@ -118,6 +284,750 @@ static bool configure_db(sqlite3 *db, struct storage_db_config *config)
 	return true;
 }
 
+/* Integer result of a pragma, -1 on error */
+static int64_t query_int(sqlite3 *db, const char *sql)
+{
+	sqlite3_stmt *stmt;
+	int64_t value = -1;
+	
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+		return -1;
+	
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		value = sqlite3_column_int64(stmt, 0);
+	
+	sqlite3_finalize(stmt);
+	return value;
+}
+
+/* auto_vacuum mode of the database, 0 (NONE) on error */
+static int query_auto_vacuum(sqlite3 *db)
+{
+	int64_t mode = query_int(db, "PRAGMA auto_vacuum");
+	
+	return mode > 0 ? (int)mode : 0;
+}
+
+/* Run sql, false with a message on error */
+static bool exec_sql(struct storage_db *db, const char *sql, const char *what)
+{
+	char *err_msg = NULL;
+	
+	if (sqlite3_exec(db->db, sql, NULL, NULL, &err_msg) != SQLITE_OK) {
+		fprintf(stderr, "Failed to %s: %s\n", what, err_msg);
+		sqlite3_free(err_msg);
+		return false;
+	}
+	
+	return true;
+}
+
+/* Finalize all cached statements, before tables they may use go away */
+static void stmt_cache_clear(struct storage_db *db)
+{
+	for (size_t i = 0; i < STMT_CACHE_SIZE; i++) {
+		struct db_cached_stmt *entry = &db->stmt_cache[i];
+		
+		if (!entry->sql)
+			continue;
+		sqlite3_finalize(entry->stmt);
+		free(entry->sql);
+		entry->sql = NULL;
+		entry->stmt = NULL;
+	}
+}
+
+/*
+ * Prepared statement of sql, from the cache or prepared into the least
+ * recently used slot. Reset it with stmt_release() once done.
+ */
+static sqlite3_stmt *stmt_cache_get(struct storage_db *db, const char *sql)
+{
+	struct db_cached_stmt *victim = &db->stmt_cache[0];
+	sqlite3_stmt *stmt;
+	char *copy;
+	
+	for (size_t i = 0; i < STMT_CACHE_SIZE; i++) {
+		struct db_cached_stmt *entry = &db->stmt_cache[i];
+		
+		if (!entry->sql) {
+			if (victim->sql)
+				victim = entry;
+			continue;
+		}
+		
+		if (strcmp(entry->sql, sql) == 0) {
+			entry->used = ++db->stmt_clock;
+			return entry->stmt;
+		}
+		
+		if (victim->sql && entry->used < victim->used)
+			victim = entry;
+	}
+	
+	if (sqlite3_prepare_v2(db->db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare query: %s\n", sqlite3_errmsg(db->db));
+		return NULL;
+	}
+	
+	/* Uncached statements work as well, finalized on release */
+	copy = strdup(sql);
+	if (!copy)
+		return stmt;
+	
+	if (victim->sql) {
+		sqlite3_finalize(victim->stmt);
+		free(victim->sql);
+	}
+	victim->sql = copy;
+	victim->stmt = stmt;
+	victim->used = ++db->stmt_clock;
+	
+	return stmt;
+}
+
+/* Done with a statement of stmt_cache_get() */
+static void stmt_release(struct storage_db *db, sqlite3_stmt *stmt)
+{
+	for (size_t i = 0; i < STMT_CACHE_SIZE; i++) {
+		if (db->stmt_cache[i].stmt == stmt) {
+			sqlite3_reset(stmt);
+			sqlite3_clear_bindings(stmt);
+			return;
+		}
+	}
+	
+	sqlite3_finalize(stmt);
+}
+
+/* Values bound to the parameters of a query, in order */
+struct query_params {
+	int count;
+	struct {
+		const char *text;       /* NULL for an integer */
+		int64_t value;
+	} p[QUERY_MAX_PARAMS];
+	char lower[64];                 /* Bounds of an interface prefix */
+	char upper[64];
+};
+
+/* Add a parameter, returns its number */
+static int param_int(struct query_params *qp, int64_t value)
+{
+	qp->p[qp->count].text = NULL;
+	qp->p[qp->count].value = value;
+	return ++qp->count;
+}
+
+static int param_text(struct query_params *qp, const char *text)
+{
+	qp->p[qp->count].text = text;
+	return ++qp->count;
+}
+
+static void bind_params(sqlite3_stmt *stmt, const struct query_params *qp)
+{
+	for (int i = 0; qp && i < qp->count; i++) {
+		if (qp->p[i].text)
+			sqlite3_bind_text(stmt, i + 1, qp->p[i].text, -1, SQLITE_TRANSIENT);
+		else
+			sqlite3_bind_int64(stmt, i + 1, qp->p[i].value);
+	}
+}
+
+/*
+ * Event tables from oldest to newest: table 0 is the unpartitioned one,
+ * table i > 0 is partition i - 1.
+ */
+static size_t num_tables(struct storage_db *db)
+{
+	return db->num_partitions + 1;
+}
+
+static void table_name(struct storage_db *db, size_t i, char *name, size_t size)
+{
+	if (i == 0)
+		snprintf(name, size, "events");
+	else
+		snprintf(name, size, "events_p%" PRIu64, db->partitions[i - 1].id);
+}
+
+/* Whether table i can hold events of the filter's time range */
+static bool table_selected(struct storage_db *db, size_t i, struct db_query_filter *filter)
+{
+	uint64_t span = db->partition_span, start, end;
+	
+	if (i == 0 || !filter)
+		return true;
+	
+	start = db->partitions[i - 1].id * span;
+	end = start + span - 1;
+	
+	if (filter->start_time != 0 && end < filter->start_time)
+		return false;
+	if (filter->end_time != 0 && start > filter->end_time)
+		return false;
+	
+	return true;
+}
+
+/* Rows of table matching where, -1 on error */
+static int64_t table_count(struct storage_db *db, const char *table, const char *where,
+                           const struct query_params *qp)
+{
+	char sql[QUERY_SQL_MAX];
+	sqlite3_stmt *stmt;
+	int64_t count = -1;
+	int rc;
+	
+	snprintf(sql, sizeof(sql), "SELECT COUNT(*) FROM %s %s", table, where);
+	stmt = stmt_cache_get(db, sql);
+	if (!stmt)
+		return -1;
+	
+	bind_params(stmt, qp);
+	rc = sqlite3_step(stmt);
+	if (rc == SQLITE_ROW)
+		count = sqlite3_column_int64(stmt, 0);
+	else
+		fprintf(stderr, "Failed to count events: %s\n", sqlite3_errmsg(db->db));
+	
+	stmt_release(db, stmt);
+	return count;
+}
+
+/* Recreate the view over all event tables */
+static void update_view(struct storage_db *db)
+{
+	int limit = sqlite3_limit(db->db, SQLITE_LIMIT_COMPOUND_SELECT, -1);
+	size_t size = 64 + (db->num_partitions + 1) * 128;
+	char *sql, *p, name[32];
+	
+	exec_sql(db, "DROP VIEW IF EXISTS events_all", "drop events view");
+	
+	/* Too many tables for one compound select, queries do not need it */
+	if (limit > 0 && db->num_partitions + 1 > (size_t)limit)
+		return;
+	
+	sql = malloc(size);
+	if (!sql)
+		return;
+	
+	p = sql + snprintf(sql, size, "CREATE VIEW events_all AS SELECT " EVENT_COLUMNS " FROM events");
+	for (size_t i = 1; i < num_tables(db); i++) {
+		table_name(db, i, name, sizeof(name));
+		p += snprintf(p, size - (size_t)(p - sql), " UNION ALL SELECT " EVENT_COLUMNS " FROM %s",
+		              name);
+	}
+	
+	exec_sql(db, sql, "create events view");
+	free(sql);
+}
+
+/* Index of the partition with id, or where to insert it */
+static bool partition_find(struct storage_db *db, uint64_t id, size_t *index)
+{
+	size_t lo = 0, hi = db->num_partitions;
+	
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		
+		if (db->partitions[mid].id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	
+	*index = lo;
+	return lo < db->num_partitions && db->partitions[lo].id == id;
+}
+
+/* Add partition id at index to the list, its table exists */
+static bool partition_insert(struct storage_db *db, uint64_t id, size_t index)
+{
+	if (db->num_partitions == db->max_partitions) {
+		size_t max = db->max_partitions ? db->max_partitions * 2 : 32;
+		struct db_partition *partitions = realloc(db->partitions, max * sizeof(*partitions));
+		
+		if (!partitions)
+			return false;
+		db->partitions = partitions;
+		db->max_partitions = max;
+	}
+	
+	memmove(&db->partitions[index + 1], &db->partitions[index],
+	        (db->num_partitions - index) * sizeof(*db->partitions));
+	db->partitions[index].id = id;
+	db->partitions[index].insert_stmt = NULL;
+	db->num_partitions++;
+	
+	return true;
+}
+
+/* Create the table of partition id, connection lock held */
+static bool partition_create(struct storage_db *db, uint64_t id, size_t index)
+{
+	char sql[1024];
+	
+	snprintf(sql, sizeof(sql),
+	        "CREATE TABLE IF NOT EXISTS events_p%1$" PRIu64 " ("
+	        "  id INTEGER PRIMARY KEY AUTOINCREMENT,"
+	        "  timestamp INTEGER NOT NULL,"
+	        "  sequence INTEGER NOT NULL,"
+	        "  event_type INTEGER NOT NULL,"
+	        "  message_type INTEGER NOT NULL,"
+	        "  interface TEXT,"
+	        "  namespace TEXT,"
+	        "  details BLOB,"
+	        "  sample_weight INTEGER NOT NULL DEFAULT 1"
+	        ");"
+	        "CREATE INDEX IF NOT EXISTS idx_p%1$" PRIu64 "_timestamp ON events_p%1$" PRIu64 "(timestamp);"
+	        "CREATE INDEX IF NOT EXISTS idx_p%1$" PRIu64 "_event_type_timestamp "
+	        "ON events_p%1$" PRIu64 "(event_type, timestamp);"
+	        "CREATE INDEX IF NOT EXISTS idx_p%1$" PRIu64 "_interface_timestamp "
+	        "ON events_p%1$" PRIu64 "(interface, timestamp);"
+	        "CREATE INDEX IF NOT EXISTS idx_p%1$" PRIu64 "_namespace ON events_p%1$" PRIu64 "(namespace);",
+	        id);
+	
+	if (!exec_sql(db, sql, "create partition") || !partition_insert(db, id, index))
+		return false;
+	
+	update_view(db);
+	return true;
+}
+
+/* Drop the table of partition index, connection lock held */
+static bool partition_drop(struct storage_db *db, size_t index)
+{
+	char sql[64];
+	
+	if (db->partitions[index].insert_stmt)
+		sqlite3_finalize(db->partitions[index].insert_stmt);
+	db->partitions[index].insert_stmt = NULL;
+	
+	stmt_cache_clear(db);
+	snprintf(sql, sizeof(sql), "DROP TABLE IF EXISTS events_p%" PRIu64, db->partitions[index].id);
+	if (!exec_sql(db, sql, "drop partition"))
+		return false;
+	
+	memmove(&db->partitions[index], &db->partitions[index + 1],
+	        (db->num_partitions - index - 1) * sizeof(*db->partitions));
+	db->num_partitions--;
+	db->last_partition = 0;
+	
+	return true;
+}
+
+/* Forget all partitions, finalizing their statements */
+static void partitions_clear(struct storage_db *db)
+{
+	stmt_cache_clear(db);
+	for (size_t i = 0; i < db->num_partitions; i++) {
+		if (db->partitions[i].insert_stmt)
+			sqlite3_finalize(db->partitions[i].insert_stmt);
+	}
+	db->num_partitions = 0;
+	db->last_partition = 0;
+}
+
+/*
+ * Settle the partition span: a database partitioned before keeps the span
+ * its partition ids were made with.
+ */
+static bool partition_span_init(struct storage_db *db, uint64_t span)
+{
+	sqlite3_stmt *stmt;
+	uint64_t stored = 0;
+	char sql[128];
+	
+	if (sqlite3_prepare_v2(db->db, "SELECT value FROM metadata WHERE key = 'partition_span'",
+	                       -1, &stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to read partition span: %s\n", sqlite3_errmsg(db->db));
+		return false;
+	}
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		stored = (uint64_t)sqlite3_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
+	
+	if (stored) {
+		if (span && span != stored)
+			fprintf(stderr, "Keeping partition span %" PRIu64 " of the database\n", stored);
+		db->partition_span = stored;
+		return true;
+	}
+	
+	db->partition_span = span;
+	if (!span)
+		return true;
+	
+	snprintf(sql, sizeof(sql),
+	        "INSERT OR REPLACE INTO metadata (key, value) VALUES ('partition_span', '%" PRIu64 "')",
+	        span);
+	return exec_sql(db, sql, "store partition span");
+}
+
+/* Read the partition tables of the database */
+static bool partitions_load(struct storage_db *db)
+{
+	sqlite3_stmt *stmt;
+	bool ok = true;
+	
+	partitions_clear(db);
+	
+	if (sqlite3_prepare_v2(db->db,
+	                       "SELECT name FROM sqlite_master WHERE type = 'table' "
+	                       "AND name GLOB 'events_p[0-9]*'", -1, &stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to list partitions: %s\n", sqlite3_errmsg(db->db));
+		return false;
+	}
+	
+	while (ok && sqlite3_step(stmt) == SQLITE_ROW) {
+		const char *name = (const char *)sqlite3_column_text(stmt, 0);
+		uint64_t id = strtoull(name + strlen("events_p"), NULL, 10);
+		size_t index;
+		
+		if (!partition_find(db, id, &index))
+			ok = partition_insert(db, id, index);
+	}
+	
+	sqlite3_finalize(stmt);
+	return ok;
+}
+
+/* Insert statement of the partition of timestamp, creating it if new */
+static sqlite3_stmt *partition_insert_stmt(struct storage_db *db, uint64_t timestamp)
+{
+	uint64_t id = timestamp / db->partition_span;
+	struct db_partition *partition;
+	char sql[256];
+	size_t index;
+	
+	/* Events mostly go to the partition of the one before */
+	if (db->last_partition < db->num_partitions &&
+	    db->partitions[db->last_partition].id == id) {
+		index = db->last_partition;
+	} else if (!partition_find(db, id, &index) && !partition_create(db, id, index)) {
+		return NULL;
+	}
+	
+	db->last_partition = index;
+	partition = &db->partitions[index];
+	
+	if (!partition->insert_stmt) {
+		snprintf(sql, sizeof(sql),
+		        "INSERT INTO events_p%" PRIu64 " (" EVENT_COLUMNS ") VALUES (?, ?, ?, ?, ?, ?, ?, ?)",
+		        id);
+		if (sqlite3_prepare_v2(db->db, sql, -1, &partition->insert_stmt, NULL) != SQLITE_OK) {
+			fprintf(stderr, "Failed to prepare insert statement: %s\n",
+			        sqlite3_errmsg(db->db));
+			partition->insert_stmt = NULL;
+			return NULL;
+		}
+	}
+	
+	return partition->insert_stmt;
+}
+
+/* Insert one event into the open transaction, starting one if needed */
+static bool insert_event_row(struct storage_db *db, struct nlmon_event *event)
+{
+	sqlite3_stmt *stmt = db->insert_stmt;
+	int rc;
+	
+	/* Start transaction if not already in one */
+	if (!db->in_transaction) {
+		rc = sqlite3_exec(db->db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+		if (rc != SQLITE_OK) {
+			fprintf(stderr, "Failed to begin transaction: %s\n",
+			        sqlite3_errmsg(db->db));
+			return false;
+		}
+		db->in_transaction = true;
+		if (db->batcher) {
+			db->batch_begin_ns = now_ns();
+			db->batch_deadline_ns = db->batch_begin_ns + adaptive_batch_linger_ns(db->batcher);
+		}
+	}
+	
+	if (db->partition_span) {
+		stmt = partition_insert_stmt(db, event->timestamp);
+		if (!stmt)
+			return false;
+	}
+	
+	/* Bind parameters */
+	sqlite3_reset(stmt);
+	sqlite3_bind_int64(stmt, 1, event->timestamp);
+	sqlite3_bind_int64(stmt, 2, event->sequence);
+	sqlite3_bind_int(stmt, 3, event->event_type);
+	sqlite3_bind_int(stmt, 4, event->message_type);
+	sqlite3_bind_text(stmt, 5, event->interface, -1, SQLITE_TRANSIENT);
+	sqlite3_bind_text(stmt, 6, "", -1, SQLITE_TRANSIENT);  /* namespace placeholder */
+	
+	/* Bind event data as blob */
+	if (event->data && event->data_size > 0) {
+		sqlite3_bind_blob(stmt, 7, event->data, event->data_size, SQLITE_TRANSIENT);
+	} else {
+		sqlite3_bind_null(stmt, 7);
+	}
+	sqlite3_bind_int64(stmt, 8, nlmon_event_weight(event));
+	
+	/* Execute insert */
+	rc = sqlite3_step(stmt);
+	if (rc != SQLITE_DONE) {
+		fprintf(stderr, "Failed to insert event: %s\n", sqlite3_errmsg(db->db));
+		return false;
+	}
+	
+	db->batch_count++;
+	return true;
+}
+
+/* Insert an event, between the storage_insert probes */
+static bool insert_event(struct storage_db *db, struct nlmon_event *event)
+{
+	bool ok;
+	
+	NLMON_PROBE1(storage_insert_start, event->sequence);
+	ok = insert_event_row(db, event);
+	NLMON_PROBE2(storage_insert_done, event->sequence, ok);
+	return ok;
+}
+
+/* Commit the open transaction, connection lock held */
+static bool commit_transaction(struct storage_db *db)
+{
+	uint64_t start, end, latency_us, max;
+	int rc;
+	
+	if (!db->in_transaction)
+		return true;
+	
+	start = now_ns();
+	rc = sqlite3_exec(db->db, "COMMIT", NULL, NULL, NULL);
+	end = now_ns();
+	latency_us = (end - start) / 1000;
+	
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "Failed to commit transaction: %s\n",
+		        sqlite3_errmsg(db->db));
+		sqlite3_exec(db->db, "ROLLBACK", NULL, NULL, NULL);
+		atomic_fetch_add_explicit(&db->failed, db->batch_count, memory_order_relaxed);
+		db->in_transaction = false;
+		db->batch_count = 0;
+		
+		/* Partitions created by the transaction were rolled back with it */
+		if (db->partition_span && partitions_load(db))
+			update_view(db);
+		return false;
+	}
+	
+	/* Update statistics */
+	atomic_fetch_add_explicit(&db->committed, db->batch_count, memory_order_relaxed);
+	atomic_fetch_add_explicit(&db->commits, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&db->commit_latency_us[hist_bucket(latency_us)], 1,
+	                          memory_order_relaxed);
+	max = atomic_load_explicit(&db->commit_latency_max_us, memory_order_relaxed);
+	if (latency_us > max)
+		atomic_store_explicit(&db->commit_latency_max_us, latency_us, memory_order_relaxed);
+	if (db->queue)
+		atomic_fetch_add_explicit(&db->queue_depth_hist[hist_bucket(ring_buffer_size(db->queue))],
+		                          1, memory_order_relaxed);
+	if (db->batcher)
+		adaptive_batch_record(db->batcher, db->batch_count, start - db->batch_begin_ns,
+		                      end - start, end);
+	
+	db->in_transaction = false;
+	db->batch_count = 0;
+	
+	return true;
+}
+
+/* Wake the writer if it is parked */
+static void writer_wake(struct storage_db *db)
+{
+	/* Pairs with the fence in writer_park(), one side sees the other */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!atomic_load_explicit(&db->parked, memory_order_relaxed))
+		return;
+	
+	pthread_mutex_lock(&db->wake_lock);
+	pthread_cond_signal(&db->wake);
+	pthread_mutex_unlock(&db->wake_lock);
+}
+
+/* Sleep until events are queued or wait_ns passed */
+static void writer_park(struct storage_db *db, uint64_t wait_ns)
+{
+	struct timespec ts;
+	
+	pthread_mutex_lock(&db->wake_lock);
+	
+	atomic_store_explicit(&db->parked, true, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	
+	/* Recheck, events queued before the flag was visible send no wakeup */
+	if (ring_buffer_is_empty(db->queue) &&
+	    atomic_load_explicit(&db->running, memory_order_acquire)) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += wait_ns / 1000000000ULL;
+		ts.tv_nsec += wait_ns % 1000000000ULL;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&db->wake, &db->wake_lock, &ts);
+	}
+	
+	atomic_store_explicit(&db->parked, false, memory_order_relaxed);
+	pthread_mutex_unlock(&db->wake_lock);
+}
+
+/* Writer thread, inserts queued events and commits them in groups */
+static void *writer_thread(void *arg)
+{
+	struct storage_db *db = arg;
+	void *items[WRITER_CHUNK];
+	
+	nlmon_heartbeat_register("db-writer", NULL, NULL);
+	
+	for (;;) {
+		bool running = atomic_load_explicit(&db->running, memory_order_acquire);
+		size_t count = ring_buffer_dequeue_bulk(db->queue, items, WRITER_CHUNK);
+		size_t flushes = 0;
+		uint64_t now, wait_ns = (uint64_t)WRITER_IDLE_MS * 1000000ULL;
+		bool ok = true;
+		
+		nlmon_heartbeat_enter("db-write");
+		pthread_mutex_lock(&db->lock);
+		
+		for (size_t i = 0; i < count; i++) {
+			struct nlmon_event *event = items[i];
+			
+			if (event == &flush_marker) {
+				flushes++;
+				continue;
+			}
+			
+			if (!insert_event(db, event))
+				atomic_fetch_add_explicit(&db->failed, 1, memory_order_relaxed);
+			nlmon_event_put(event);
+		}
+		
+		/* Group commit on count, linger deadline, flush or shutdown */
+		now = now_ns();
+		if (db->in_transaction &&
+		    (db->batch_count >= adaptive_batch_size(db->batcher) ||
+		     now >= db->batch_deadline_ns ||
+		     flushes > 0 || (!running && count == 0)))
+			ok = commit_transaction(db);
+		if (db->in_transaction)
+			wait_ns = db->batch_deadline_ns - now;
+		
+		pthread_mutex_unlock(&db->lock);
+		nlmon_heartbeat_leave(NULL);
+		
+		if (flushes > 0) {
+			pthread_mutex_lock(&db->wake_lock);
+			db->flush_done += flushes;
+			db->flush_ok = ok;
+			pthread_cond_broadcast(&db->flushed);
+			pthread_mutex_unlock(&db->wake_lock);
+		}
+		
+		if (count == WRITER_CHUNK)
+			continue;
+		
+		/* Stop once everything queued before shutdown is committed */
+		if (!running && count == 0)
+			break;
+		
+		if (count == 0)
+			writer_park(db, wait_ns);
+	}
+	
+	nlmon_heartbeat_unregister();
+	return NULL;
+}
+
+/* Start the async writer */
+static int writer_start(struct storage_db *db, struct storage_db_config *config)
+{
+	size_t queue_size = config->queue_size > 0 ? config->queue_size : DEFAULT_QUEUE_SIZE;
+	uint32_t interval_ms = config->commit_interval_ms > 0 ?
+	                       config->commit_interval_ms : DEFAULT_COMMIT_INTERVAL_MS;
+	struct adaptive_batch_config batching = {
+		.max_size = config->commit_count > 0 ? config->commit_count : DEFAULT_COMMIT_COUNT,
+		.target_us = (uint64_t)config->commit_latency_ms * 1000,
+		.max_linger_us = (uint64_t)interval_ms * 1000,
+	};
+	
+	db->queue = ring_buffer_create_mpmc(queue_size);
+	if (!db->queue)
+		return -1;
+	
+	db->batcher = adaptive_batch_create("storage", &batching);
+	if (!db->batcher)
+		goto fail_queue;
+	atomic_init(&db->running, true);
+	atomic_init(&db->parked, false);
+	
+	if (pthread_mutex_init(&db->wake_lock, NULL) != 0)
+		goto fail_batcher;
+	if (pthread_cond_init(&db->wake, NULL) != 0)
+		goto fail_wake_lock;
+	if (pthread_cond_init(&db->flushed, NULL) != 0)
+		goto fail_wake;
+	if (pthread_mutex_init(&db->flush_lock, NULL) != 0)
+		goto fail_flushed;
+	if (pthread_create(&db->writer, NULL, writer_thread, db) != 0)
+		goto fail_flush_lock;
+	
+	return 0;
+	
+fail_flush_lock:
+	pthread_mutex_destroy(&db->flush_lock);
+fail_flushed:
+	pthread_cond_destroy(&db->flushed);
+fail_wake:
+	pthread_cond_destroy(&db->wake);
+fail_wake_lock:
+	pthread_mutex_destroy(&db->wake_lock);
+fail_batcher:
+	adaptive_batch_destroy(db->batcher);
+	db->batcher = NULL;
+fail_queue:
+	ring_buffer_destroy(db->queue);
+	db->queue = NULL;
+	return -1;
+}
+
+/* Stop the async writer after it committed what is queued */
+static void writer_stop(struct storage_db *db)
+{
+	void *item;
+	
+	atomic_store_explicit(&db->running, false, memory_order_release);
+	pthread_mutex_lock(&db->wake_lock);
+	pthread_cond_signal(&db->wake);
+	pthread_mutex_unlock(&db->wake_lock);
+	pthread_join(db->writer, NULL);
+	
+	/* Events queued by callers racing with close */
+	while ((item = ring_buffer_dequeue(db->queue)) != NULL) {
+		if (item != &flush_marker)
+			nlmon_event_put(item);
+	}
+	
+	ring_buffer_destroy(db->queue);
+	adaptive_batch_destroy(db->batcher);
+	db->batcher = NULL;
+	pthread_mutex_destroy(&db->flush_lock);
+	pthread_cond_destroy(&db->flushed);
+	pthread_cond_destroy(&db->wake);
+	pthread_mutex_destroy(&db->wake_lock);
+}
+
 struct storage_db *storage_db_open(struct storage_db_config *config)
 {
 	struct storage_db *sdb;
@@ -139,6 +1049,10 @@ struct storage_db *storage_db_open(struct storage_db_config *config)
 		return NULL;
 	}
 	
+	/* Only takes effect while the database is still empty */
+	if (config->partition_span)
+		sqlite3_exec(sdb->db, "PRAGMA auto_vacuum = INCREMENTAL", NULL, NULL, NULL);
+	
 	/* Initialize schema */
 	if (!init_schema(sdb->db)) {
 		sqlite3_close(sdb->db);
@@ -163,215 +1077,592 @@ struct storage_db *storage_db_open(struct storage_db_config *config)
 		return NULL;
 	}
 	
+	if (pthread_mutex_init(&sdb->lock, NULL) != 0) {
+		sqlite3_finalize(sdb->insert_stmt);
+		sqlite3_close(sdb->db);
+		free(sdb);
+		return NULL;
+	}
+	
 	sdb->batch_size = config->batch_size > 0 ? config->batch_size : DEFAULT_BATCH_SIZE;
 	sdb->batch_count = 0;
 	sdb->in_transaction = false;
 	
-	return sdb;
+	/* Find the partitions of earlier runs */
+	sdb->incremental_vacuum = query_auto_vacuum(sdb->db) == 2;
+	if (!partition_span_init(sdb, config->partition_span) || !partitions_load(sdb)) {
+		partitions_clear(sdb);
+		free(sdb->partitions);
+		pthread_mutex_destroy(&sdb->lock);
+		sqlite3_finalize(sdb->insert_stmt);
+		sqlite3_close(sdb->db);
+		free(sdb);
+		return NULL;
+	}
+	if (sdb->partition_span)
+		update_view(sdb);
+	
+	/* Start async writer if configured */
+	if (config->async_writer && writer_start(sdb, config) < 0) {
+		fprintf(stderr, "Failed to start database writer\n");
+		partitions_clear(sdb);
+		free(sdb->partitions);
+		pthread_mutex_destroy(&sdb->lock);
+		sqlite3_finalize(sdb->insert_stmt);
+		sqlite3_close(sdb->db);
+		free(sdb);
+		return NULL;
+	}
+	
+	return sdb;
+}
+
+void storage_db_close(struct storage_db *db)
+{
+	if (!db)
+		return;
+	
+	/* Flush any pending inserts */
+	if (db->queue)
+		writer_stop(db);
+	else
+		storage_db_flush(db);
+	
+	/* Finalize prepared statements */
+	if (db->insert_stmt)
+		sqlite3_finalize(db->insert_stmt);
+	partitions_clear(db);
+	free(db->partitions);
+	
+	/* Close database */
+	if (db->db)
+		sqlite3_close(db->db);
+	
+	pthread_mutex_destroy(&db->lock);
+	free(db);
+}
+
+bool storage_db_insert(struct storage_db *db, struct nlmon_event *event)
+{
+	struct nlmon_event *ref;
+	bool ok = true;
+	
+	if (!db || !event)
+		return false;
+	
+	/* Queue for the writer, refcounted events are not copied */
+	if (db->queue) {
+		ref = nlmon_event_share(event);
+		if (!ref)
+			return false;
+		
+		if (!ring_buffer_enqueue(db->queue, ref)) {
+			nlmon_event_put(ref);
+			atomic_fetch_add_explicit(&db->dropped, 1, memory_order_relaxed);
+			return false;
+		}
+		
+		atomic_fetch_add_explicit(&db->queued, 1, memory_order_relaxed);
+		writer_wake(db);
+		return true;
+	}
+	
+	pthread_mutex_lock(&db->lock);
+	
+	if (!insert_event(db, event))
+		ok = false;
+	else if (db->batch_count >= db->batch_size)
+		ok = commit_transaction(db);  /* Commit transaction if batch is full */
+	
+	pthread_mutex_unlock(&db->lock);
+	
+	return ok;
+}
+
+bool storage_db_flush(struct storage_db *db)
+{
+	uint64_t ticket;
+	bool ok;
+	
+	if (!db)
+		return true;
+	
+	if (!db->queue) {
+		pthread_mutex_lock(&db->lock);
+		ok = commit_transaction(db);
+		pthread_mutex_unlock(&db->lock);
+		return ok;
+	}
+	
+	/* Queue a marker behind the caller's events, markers in ticket order */
+	pthread_mutex_lock(&db->flush_lock);
+	ticket = ++db->flush_requested;
+	while (!ring_buffer_enqueue(db->queue, &flush_marker)) {
+		writer_wake(db);
+		usleep(1000);
+	}
+	writer_wake(db);
+	pthread_mutex_unlock(&db->flush_lock);
+	
+	pthread_mutex_lock(&db->wake_lock);
+	while (db->flush_done < ticket)
+		pthread_cond_wait(&db->flushed, &db->wake_lock);
+	ok = db->flush_ok;
+	pthread_mutex_unlock(&db->wake_lock);
+	
+	return ok;
+}
+
+bool storage_db_get_writer_stats(struct storage_db *db,
+                                 struct storage_db_writer_stats *stats)
+{
+	if (!db || !stats || !db->queue)
+		return false;
+	
+	stats->queued = atomic_load_explicit(&db->queued, memory_order_relaxed);
+	stats->dropped = atomic_load_explicit(&db->dropped, memory_order_relaxed);
+	stats->committed = atomic_load_explicit(&db->committed, memory_order_relaxed);
+	stats->failed = atomic_load_explicit(&db->failed, memory_order_relaxed);
+	stats->commits = atomic_load_explicit(&db->commits, memory_order_relaxed);
+	stats->queue_depth = ring_buffer_size(db->queue);
+	stats->commit_latency_max_us = atomic_load_explicit(&db->commit_latency_max_us,
+	                                                    memory_order_relaxed);
+	for (size_t i = 0; i < STORAGE_DB_HIST_BUCKETS; i++) {
+		stats->commit_latency_us[i] = atomic_load_explicit(&db->commit_latency_us[i],
+		                                                   memory_order_relaxed);
+		stats->queue_depth_hist[i] = atomic_load_explicit(&db->queue_depth_hist[i],
+		                                                  memory_order_relaxed);
+	}
+	
+	return true;
+}
+
+/* Columns filter->order_by may name */
+static const char *const order_columns[] = {
+	"timestamp", "sequence", "event_type", "message_type", "interface", "namespace",
+};
+
+/* Order column of filter, NULL if it names none */
+static const char *query_order(struct db_query_filter *filter)
+{
+	if (!filter || !filter->order_by)
+		return "timestamp";
+	
+	for (size_t i = 0; i < sizeof(order_columns) / sizeof(order_columns[0]); i++) {
+		if (strcmp(filter->order_by, order_columns[i]) == 0)
+			return order_columns[i];
+	}
+	
+	fprintf(stderr, "Unknown order column: %s\n", filter->order_by);
+	return NULL;
+}
+
+/* Append a condition to a WHERE clause */
+__attribute__((format(printf, 3, 4)))
+static void where_add(char *where, size_t size, const char *fmt, ...)
+{
+	size_t len = strlen(where);
+	va_list ap;
+	
+	len += snprintf(where + len, size - len, "%s", len ? " AND " : "WHERE ");
+	if (len >= size)
+		return;
+	
+	va_start(ap, fmt);
+	vsnprintf(where + len, size - len, fmt, ap);
+	va_end(ap);
+}
+
+/* SQL of a filter expression being built */
+struct expr_sql {
+	char *data;
+	size_t len;
+	int params;                     /* Parameters added */
+	bool overflow;                  /* Out of room, nothing is pushed */
+};
+
+__attribute__((format(printf, 2, 3)))
+static void expr_add(struct expr_sql *b, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+	
+	if (b->overflow)
+		return;
+	
+	va_start(ap, fmt);
+	n = vsnprintf(b->data + b->len, EXPR_SQL_MAX - b->len, fmt, ap);
+	va_end(ap);
+	
+	if (n < 0 || (size_t)n >= EXPR_SQL_MAX - b->len)
+		b->overflow = true;
+	else
+		b->len += (size_t)n;
+}
+
+/* Parameter of a literal, 0 without room */
+static int expr_param(struct expr_sql *b, struct query_params *qp,
+                      const struct filter_node *literal)
+{
+	if (b->params == EXPR_MAX_PARAMS) {
+		b->overflow = true;
+		return 0;
+	}
+	
+	b->params++;
+	if (literal->type == FILTER_NODE_STRING)
+		return param_text(qp, literal->data.string.value);
+	return param_int(qp, literal->data.number.value);
+}
+
+/* Column of a field, NULL for fields not stored */
+static const char *expr_column(enum filter_field_type field, bool *text)
+{
+	*text = field == FILTER_FIELD_INTERFACE || field == FILTER_FIELD_NAMESPACE;
+	
+	switch (field) {
+	case FILTER_FIELD_INTERFACE: return "interface";
+	case FILTER_FIELD_NAMESPACE: return "namespace";
+	case FILTER_FIELD_EVENT_TYPE: return "event_type";
+	case FILTER_FIELD_MESSAGE_TYPE: return "message_type";
+	case FILTER_FIELD_TIMESTAMP: return "timestamp";
+	case FILTER_FIELD_SEQUENCE: return "sequence";
+	default: return NULL;
+	}
+}
+
+/* Whether a literal has the type of a column, filter_eval() never matches mismatched ones */
+static bool expr_typed(const struct filter_node *literal, bool text)
+{
+	return literal->type == (text ? FILTER_NODE_STRING : FILTER_NODE_NUMBER);
+}
+
+/* SQL of a comparison of a column with literals, false if not stored */
+static bool expr_compare(struct expr_sql *b, struct query_params *qp,
+                         const struct filter_node *node)
+{
+	static const char *const ops[] = {
+		[FILTER_NODE_EQ] = "=", [FILTER_NODE_NE] = "!=",
+		[FILTER_NODE_LT] = "<", [FILTER_NODE_GT] = ">",
+		[FILTER_NODE_LE] = "<=", [FILTER_NODE_GE] = ">=",
+	};
+	const struct filter_node *field = node->data.binary.left;
+	const struct filter_node *literal = node->data.binary.right;
+	enum filter_node_type op = node->type;
+	const char *column, *sep = "";
+	bool text;
+	
+	/* A literal on the left compares the other way round */
+	if (field->type != FILTER_NODE_FIELD && op != FILTER_NODE_IN) {
+		field = literal;
+		literal = node->data.binary.left;
+		op = op == FILTER_NODE_LT ? FILTER_NODE_GT : op == FILTER_NODE_GT ? FILTER_NODE_LT :
+		     op == FILTER_NODE_LE ? FILTER_NODE_GE : op == FILTER_NODE_GE ? FILTER_NODE_LE : op;
+	}
+	if (field->type != FILTER_NODE_FIELD)
+		return false;
+	column = expr_column(field->data.field.field, &text);
+	if (!column)
+		return false;
+	
+	if (op != FILTER_NODE_IN) {
+		if (literal->type != FILTER_NODE_STRING && literal->type != FILTER_NODE_NUMBER)
+			return false;
+		if (!expr_typed(literal, text))
+			expr_add(b, "0");
+		else
+			expr_add(b, "%s %s ?%d", column, ops[op], expr_param(b, qp, literal));
+		return true;
+	}
+	
+	if (literal->type != FILTER_NODE_LIST)
+		return false;
+	
+	expr_add(b, "%s IN (", column);
+	for (size_t i = 0; i < literal->data.list.count; i++) {
+		const struct filter_node *item = literal->data.list.items[i];
+		
+		if (!expr_typed(item, text))
+			continue;
+		expr_add(b, "%s?%d", sep, expr_param(b, qp, item));
+		sep = ", ";
+	}
+	
+	/* No item of the column's type, nothing matches */
+	if (!*sep && !b->overflow) {
+		b->len -= strlen(column) + 5;
+		expr_add(b, "0");
+		return true;
+	}
+	expr_add(b, ")");
+	return true;
+}
+
+/*
+ * Append the SQL of the stored columns' part of an expression. False if
+ * none of it is, then nothing is appended. Comparisons of other fields
+ * and regular expressions are left out of an AND, which then matches a
+ * superset, and clear exact; an OR or NOT needs all of its operands.
+ */
+static bool expr_build(struct expr_sql *b, struct query_params *qp,
+                       const struct filter_node *node, bool *exact)
+{
+	size_t len = b->len;
+	int count = qp->count, params = b->params;
+	bool l, r, inner = true;
+	
+	switch (node->type) {
+	case FILTER_NODE_AND:
+	case FILTER_NODE_OR:
+		expr_add(b, "(");
+		l = expr_build(b, qp, node->data.binary.left, &inner);
+		if (l)
+			expr_add(b, node->type == FILTER_NODE_AND ? " AND " : " OR ");
+		r = expr_build(b, qp, node->data.binary.right, &inner);
+		if (l && !r && !b->overflow)
+			b->len -= node->type == FILTER_NODE_AND ? 5 : 4;
+		if (node->type == FILTER_NODE_OR ? l && r : l || r) {
+			expr_add(b, ")");
+			*exact = *exact && inner;
+			return true;
+		}
+		break;
+		
+	case FILTER_NODE_NOT:
+		expr_add(b, "NOT (");
+		if (expr_build(b, qp, node->data.unary.operand, &inner) && inner) {
+			expr_add(b, ")");
+			return true;
+		}
+		break;
+		
+	case FILTER_NODE_EQ:
+	case FILTER_NODE_NE:
+	case FILTER_NODE_LT:
+	case FILTER_NODE_GT:
+	case FILTER_NODE_LE:
+	case FILTER_NODE_GE:
+	case FILTER_NODE_IN:
+		if (expr_compare(b, qp, node))
+			return true;
+		break;
+		
+	default:
+		break;
+	}
+	
+	/* Left out, filter_eval() decides it after the fetch */
+	b->len = len;
+	b->data[len] = '\0';
+	b->params = params;
+	qp->count = count;
+	*exact = false;
+	return false;
 }
 
-void storage_db_close(struct storage_db *db)
+/* Add the stored columns' part of an expression to a WHERE clause, false if inexact */
+static bool expr_where(const struct filter_node *expr, char *where, size_t size,
+                       struct query_params *qp)
 {
-	if (!db)
-		return;
+	char sql[EXPR_SQL_MAX] = "";
+	struct expr_sql b = { .data = sql };
+	int count = qp->count;
+	bool exact = true;
 	
-	/* Flush any pending inserts */
-	storage_db_flush(db);
+	if (!expr_build(&b, qp, expr, &exact))
+		return false;
 	
-	/* Finalize prepared statement */
-	if (db->insert_stmt)
-		sqlite3_finalize(db->insert_stmt);
+	if (b.overflow) {
+		qp->count = count;
+		return false;
+	}
 	
-	/* Close database */
-	if (db->db)
-		sqlite3_close(db->db);
+	where_add(where, size, "%s", sql);
+	return exact;
+}
+
+bool storage_db_expr_pushable(const struct filter_node *expr)
+{
+	struct query_params qp = { 0 };
+	char where[WHERE_MAX] = "";
 	
-	free(db);
+	return !expr || expr_where(expr, where, sizeof(where), &qp);
 }
 
-bool storage_db_insert(struct storage_db *db, struct nlmon_event *event)
+/*
+ * Build WHERE clause from filter. Values are bound through numbered
+ * parameters, so the SQL only depends on the filter's shape and its
+ * statement is prepared once.
+ */
+static void build_where_clause(struct db_query_filter *filter, char *where, size_t size,
+                               struct query_params *qp)
 {
-	int rc;
+	*where = '\0';
+	qp->count = 0;
 	
-	if (!db || !event)
-		return false;
+	if (!filter)
+		return;
 	
-	/* Start transaction if not already in one */
-	if (!db->in_transaction) {
-		rc = sqlite3_exec(db->db, "BEGIN TRANSACTION", NULL, NULL, NULL);
-		if (rc != SQLITE_OK) {
-			fprintf(stderr, "Failed to begin transaction: %s\n",
-			        sqlite3_errmsg(db->db));
-			return false;
+	if (filter->interface_pattern) {
+		const char *pattern = filter->interface_pattern;
+		size_t prefix = strcspn(pattern, "%_");
+		
+		if (pattern[prefix] == '\0') {
+			where_add(where, size, "interface = ?%d", param_text(qp, pattern));
+		} else if (prefix > 0 && prefix < sizeof(qp->lower) &&
+		           (unsigned char)pattern[prefix - 1] < 0xff) {
+			/* The literal prefix bounds the scan of the interface index */
+			memcpy(qp->lower, pattern, prefix);
+			qp->lower[prefix] = '\0';
+			memcpy(qp->upper, qp->lower, prefix + 1);
+			qp->upper[prefix - 1]++;
+			where_add(where, size, "interface >= ?%d", param_text(qp, qp->lower));
+			where_add(where, size, "interface < ?%d", param_text(qp, qp->upper));
+			where_add(where, size, "interface LIKE ?%d", param_text(qp, pattern));
+		} else {
+			where_add(where, size, "interface LIKE ?%d", param_text(qp, pattern));
 		}
-		db->in_transaction = true;
 	}
 	
-	/* Bind parameters */
-	sqlite3_reset(db->insert_stmt);
-	sqlite3_bind_int64(db->insert_stmt, 1, event->timestamp);
-	sqlite3_bind_int64(db->insert_stmt, 2, event->sequence);
-	sqlite3_bind_int(db->insert_stmt, 3, event->event_type);
-	sqlite3_bind_int(db->insert_stmt, 4, event->message_type);
-	sqlite3_bind_text(db->insert_stmt, 5, event->interface, -1, SQLITE_TRANSIENT);
-	sqlite3_bind_text(db->insert_stmt, 6, "", -1, SQLITE_TRANSIENT);  /* namespace placeholder */
+	if (filter->event_type != 0)
+		where_add(where, size, "event_type = ?%d", param_int(qp, filter->event_type));
 	
-	/* Bind event data as blob */
-	if (event->data && event->data_size > 0) {
-		sqlite3_bind_blob(db->insert_stmt, 7, event->data, event->data_size, SQLITE_TRANSIENT);
-	} else {
-		sqlite3_bind_null(db->insert_stmt, 7);
-	}
+	if (filter->message_type != 0)
+		where_add(where, size, "message_type = ?%d", param_int(qp, filter->message_type));
 	
-	/* Execute insert */
-	rc = sqlite3_step(db->insert_stmt);
-	if (rc != SQLITE_DONE) {
-		fprintf(stderr, "Failed to insert event: %s\n", sqlite3_errmsg(db->db));
-		return false;
-	}
+	if (filter->namespace)
+		where_add(where, size, "namespace = ?%d", param_text(qp, filter->namespace));
 	
-	db->batch_count++;
+	if (filter->start_time != 0)
+		where_add(where, size, "timestamp >= ?%d", param_int(qp, (int64_t)filter->start_time));
 	
-	/* Commit transaction if batch is full */
-	if (db->batch_count >= db->batch_size) {
-		return storage_db_flush(db);
-	}
+	if (filter->end_time != 0)
+		where_add(where, size, "timestamp <= ?%d", param_int(qp, (int64_t)filter->end_time));
 	
-	return true;
+	if (filter->expr)
+		expr_where(filter->expr, where, size, qp);
 }
 
-bool storage_db_flush(struct storage_db *db)
+/* Cursor key of table i, stable while partitions come and go */
+static uint64_t table_key(struct storage_db *db, size_t i)
 {
-	int rc;
+	return i == 0 ? 0 : db->partitions[i - 1].id + 1;
+}
+
+/*
+ * SQL of the query of table i, limit < 0 for none. False if the table
+ * lies wholly before the filter's cursor.
+ */
+static bool table_query(struct storage_db *db, size_t i, struct db_query_filter *filter,
+                        const char *order, const char *where, int64_t limit,
+                        struct query_params *qp, char *sql, size_t size)
+{
+	const char *dir = filter && filter->descending ? "DESC" : "ASC";
+	char name[32], cond[WHERE_MAX], limit_clause[32] = "";
 	
-	if (!db || !db->in_transaction)
-		return true;
+	table_name(db, i, name, sizeof(name));
+	snprintf(cond, sizeof(cond), "%s", where);
 	
-	rc = sqlite3_exec(db->db, "COMMIT", NULL, NULL, NULL);
-	if (rc != SQLITE_OK) {
-		fprintf(stderr, "Failed to commit transaction: %s\n",
-		        sqlite3_errmsg(db->db));
-		sqlite3_exec(db->db, "ROLLBACK", NULL, NULL, NULL);
-		db->in_transaction = false;
-		db->batch_count = 0;
-		return false;
+	if (filter && filter->after_cursor) {
+		uint64_t key = table_key(db, i), cursor = filter->cursor.table;
+		
+		if (filter->descending ? key > cursor : key < cursor)
+			return false;
+		
+		if (key == cursor) {
+			int ts = param_int(qp, (int64_t)filter->cursor.timestamp);
+			int id = param_int(qp, filter->cursor.id);
+			
+			where_add(cond, sizeof(cond), "(timestamp, id) %s (?%d, ?%d)",
+			          filter->descending ? "<" : ">", ts, id);
+		}
 	}
 	
-	db->in_transaction = false;
-	db->batch_count = 0;
+	if (limit >= 0)
+		snprintf(limit_clause, sizeof(limit_clause), " LIMIT ?%d", param_int(qp, limit));
+	
+	/* Ties are broken by id, keeping pages apart */
+	snprintf(sql, size, "SELECT " EVENT_COLUMNS ", id FROM %s %s ORDER BY %s %s, id %s%s",
+	         name, cond, order, dir, dir, limit_clause);
 	
 	return true;
 }
 
-/* Build WHERE clause from filter */
-static void build_where_clause(struct db_query_filter *filter, char *where, size_t size)
+/*
+ * SQL of a query ordered by another column than timestamp, as one
+ * compound select over the tables of the time range. Returns NULL on
+ * error, else a string to free.
+ */
+static char *union_query(struct storage_db *db, struct db_query_filter *filter,
+                         const char *order, const char *where, struct query_params *qp)
 {
-	char *p = where;
-	size_t remaining = size;
-	int n;
-	bool first = true;
+	int max = sqlite3_limit(db->db, SQLITE_LIMIT_COMPOUND_SELECT, -1);
+	size_t size = 256 + num_tables(db) * (128 + strlen(where)), selected = 0;
+	const char *dir = filter->descending ? "DESC" : "ASC";
+	char *sql, *p, name[32];
 	
-	*p = '\0';
-	
-	if (!filter)
-		return;
-	
-	if (filter->interface_pattern) {
-		n = snprintf(p, remaining, "%sinterface LIKE '%s'",
-		            first ? "WHERE " : " AND ", filter->interface_pattern);
-		p += n;
-		remaining -= n;
-		first = false;
-	}
-	
-	if (filter->event_type != 0) {
-		n = snprintf(p, remaining, "%sevent_type = %u",
-		            first ? "WHERE " : " AND ", filter->event_type);
-		p += n;
-		remaining -= n;
-		first = false;
-	}
+	sql = malloc(size);
+	if (!sql)
+		return NULL;
 	
-	if (filter->message_type != 0) {
-		n = snprintf(p, remaining, "%smessage_type = %u",
-		            first ? "WHERE " : " AND ", filter->message_type);
-		p += n;
-		remaining -= n;
-		first = false;
+	p = sql + snprintf(sql, size, "SELECT * FROM (");
+	for (size_t i = 0; i < num_tables(db); i++) {
+		if (!table_selected(db, i, filter))
+			continue;
+		table_name(db, i, name, sizeof(name));
+		p += snprintf(p, size - (size_t)(p - sql), "%sSELECT " EVENT_COLUMNS ", id FROM %s %s",
+		              selected++ ? " UNION ALL " : "", name, where);
 	}
 	
-	if (filter->namespace) {
-		n = snprintf(p, remaining, "%snamespace = '%s'",
-		            first ? "WHERE " : " AND ", filter->namespace);
-		p += n;
-		remaining -= n;
-		first = false;
+	if (max > 0 && selected > (size_t)max) {
+		fprintf(stderr, "Query spans %zu partitions, more than %d\n", selected, max);
+		free(sql);
+		return NULL;
 	}
 	
-	if (filter->start_time != 0) {
-		n = snprintf(p, remaining, "%stimestamp >= %lu",
-		            first ? "WHERE " : " AND ", filter->start_time);
-		p += n;
-		remaining -= n;
-		first = false;
+	p += snprintf(p, size - (size_t)(p - sql), ") ORDER BY %s %s", order, dir);
+	if (filter->limit > 0) {
+		int limit = param_int(qp, (int64_t)filter->limit);
+		int offset = param_int(qp, (int64_t)filter->offset);
+		
+		snprintf(p, size - (size_t)(p - sql), " LIMIT ?%d OFFSET ?%d", limit, offset);
 	}
 	
-	if (filter->end_time != 0) {
-		n = snprintf(p, remaining, "%stimestamp <= %lu",
-		            first ? "WHERE " : " AND ", filter->end_time);
-		p += n;
-		remaining -= n;
-		first = false;
-	}
+	return sql;
 }
 
-int storage_db_query(struct storage_db *db,
-                     struct db_query_filter *filter,
-                     db_query_callback_t callback,
-                     void *ctx)
+/* State of a query running over the event tables */
+struct query_run {
+	db_query_callback_t callback;
+	void *ctx;
+	size_t skip;                    /* Rows still to drop for the offset */
+	size_t left;                    /* Rows still to return */
+	int count;
+	struct db_query_cursor *cursor; /* Set to each row returned, or NULL */
+};
+
+/* Run an event query of the table with cursor key, connection lock held */
+static bool query_rows(struct storage_db *db, const char *sql, const struct query_params *qp,
+                       uint64_t key, struct query_run *run)
 {
-	char sql[1024];
-	char where[512];
 	sqlite3_stmt *stmt;
-	int rc;
-	int count = 0;
-	
-	if (!db || !callback)
-		return -1;
+	int rc = SQLITE_DONE;
 	
-	/* Build query */
-	build_where_clause(filter, where, sizeof(where));
-	
-	snprintf(sql, sizeof(sql),
-	        "SELECT timestamp, sequence, event_type, message_type, "
-	        "interface, namespace, details FROM events %s ORDER BY %s %s",
-	        where,
-	        filter && filter->order_by ? filter->order_by : "timestamp",
-	        filter && filter->descending ? "DESC" : "ASC");
-	
-	if (filter && filter->limit > 0) {
-		char limit_clause[64];
-		snprintf(limit_clause, sizeof(limit_clause), " LIMIT %zu", filter->limit);
-		strncat(sql, limit_clause, sizeof(sql) - strlen(sql) - 1);
-		
-		if (filter->offset > 0) {
-			char offset_clause[64];
-			snprintf(offset_clause, sizeof(offset_clause), " OFFSET %zu", filter->offset);
-			strncat(sql, offset_clause, sizeof(sql) - strlen(sql) - 1);
-		}
-	}
+	stmt = stmt_cache_get(db, sql);
+	if (!stmt)
+		return false;
 	
-	/* Prepare statement */
-	rc = sqlite3_prepare_v2(db->db, sql, -1, &stmt, NULL);
-	if (rc != SQLITE_OK) {
-		fprintf(stderr, "Failed to prepare query: %s\n", sqlite3_errmsg(db->db));
-		return -1;
-	}
+	bind_params(stmt, qp);
 	
 	/* Execute query */
-	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+	while (run->left > 0 && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		struct nlmon_event event = {0};
 		
+		if (run->skip > 0) {
+			run->skip--;
+			continue;
+		}
+		
 		event.timestamp = sqlite3_column_int64(stmt, 0);
 		event.sequence = sqlite3_column_int64(stmt, 1);
 		event.event_type = sqlite3_column_int(stmt, 2);
@@ -385,100 +1676,339 @@ int storage_db_query(struct storage_db *db,
 		const void *blob = sqlite3_column_blob(stmt, 6);
 		int blob_size = sqlite3_column_bytes(stmt, 6);
 		
-		if (blob && blob_size > 0) {
-			event.data = malloc(blob_size);
-			if (event.data) {
-				memcpy(event.data, blob, blob_size);
-				event.data_size = blob_size;
-			}
+		if (blob && blob_size > 0)
+			nlmon_event_copy_data(&event, blob, blob_size);
+		event.sample_weight = (uint32_t)sqlite3_column_int64(stmt, 7);
+		
+		if (run->cursor) {
+			run->cursor->table = key;
+			run->cursor->timestamp = event.timestamp;
+			run->cursor->id = sqlite3_column_int64(stmt, 8);
 		}
 		
-		callback(&event, ctx);
+		run->callback(&event, run->ctx);
 		
-		if (event.data)
-			free(event.data);
+		nlmon_event_free_data(&event);
 		
-		count++;
+		run->left--;
+		run->count++;
 	}
 	
-	sqlite3_finalize(stmt);
+	stmt_release(db, stmt);
 	
-	if (rc != SQLITE_DONE) {
+	if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
 		fprintf(stderr, "Query execution failed: %s\n", sqlite3_errmsg(db->db));
+		return false;
+	}
+	
+	return true;
+}
+
+int storage_db_query(struct storage_db *db,
+                     struct db_query_filter *filter,
+                     db_query_callback_t callback,
+                     void *ctx)
+{
+	char sql[QUERY_SQL_MAX];
+	char where[WHERE_MAX];
+	struct query_params qp, table_qp;
+	struct query_run run = { .callback = callback, .ctx = ctx, .left = SIZE_MAX };
+	const char *order;
+	bool descending = filter && filter->descending;
+	bool by_timestamp;
+	bool ok = true;
+	size_t n;
+	
+	if (!db || !callback)
+		return -1;
+	
+	order = query_order(filter);
+	if (!order)
+		return -1;
+	
+	by_timestamp = strcmp(order, "timestamp") == 0;
+	if (filter && filter->after_cursor && !by_timestamp) {
+		fprintf(stderr, "Query cursors need timestamp order\n");
 		return -1;
 	}
 	
-	return count;
+	/* Build query */
+	build_where_clause(filter, where, sizeof(where), &qp);
+	
+	if (filter && filter->limit > 0) {
+		run.left = filter->limit;
+		run.skip = filter->after_cursor ? 0 : filter->offset;
+	}
+	if (filter && by_timestamp)
+		run.cursor = &filter->cursor;
+	
+	pthread_mutex_lock(&db->lock);
+	
+	if (db->num_partitions > 0 && !by_timestamp) {
+		char *union_sql = union_query(db, filter, order, where, &qp);
+		
+		/* The compound select applies limit and offset itself */
+		run.skip = 0;
+		run.left = SIZE_MAX;
+		ok = union_sql && query_rows(db, union_sql, &qp, 0, &run);
+		free(union_sql);
+		pthread_mutex_unlock(&db->lock);
+		return ok ? run.count : -1;
+	}
+	
+	/* Tables are in timestamp order, read them one after the other */
+	n = num_tables(db);
+	for (size_t j = 0; ok && run.left > 0 && j < n; j++) {
+		size_t i = descending ? n - 1 - j : j;
+		int64_t limit = run.left == SIZE_MAX ? -1 : (int64_t)(run.left + run.skip);
+		
+		if (!table_selected(db, i, filter))
+			continue;
+		
+		table_qp = qp;
+		if (!table_query(db, i, filter, order, where, limit, &table_qp, sql, sizeof(sql)))
+			continue;
+		
+		ok = query_rows(db, sql, &table_qp, table_key(db, i), &run);
+	}
+	
+	pthread_mutex_unlock(&db->lock);
+	
+	return ok ? run.count : -1;
 }
 
 int storage_db_count(struct storage_db *db, struct db_query_filter *filter)
 {
-	char sql[1024];
-	char where[512];
+	char where[WHERE_MAX];
+	char name[32];
+	struct query_params qp;
+	int64_t n;
+	int count = 0;
+	
+	if (!db)
+		return -1;
+	
+	build_where_clause(filter, where, sizeof(where), &qp);
+	
+	pthread_mutex_lock(&db->lock);
+	
+	for (size_t i = 0; i < num_tables(db); i++) {
+		if (!table_selected(db, i, filter))
+			continue;
+		
+		table_name(db, i, name, sizeof(name));
+		n = table_count(db, name, where, &qp);
+		if (n < 0) {
+			count = -1;
+			break;
+		}
+		count += (int)n;
+	}
+	
+	pthread_mutex_unlock(&db->lock);
+	
+	return count;
+}
+
+int storage_db_explain(struct storage_db *db, struct db_query_filter *filter,
+                       char *plan, size_t size)
+{
+	char sql[QUERY_SQL_MAX];
+	char where[WHERE_MAX];
+	struct query_params qp;
 	sqlite3_stmt *stmt;
+	const char *order;
+	char *query = NULL;
+	size_t len = 0, n;
 	int rc;
-	int count = -1;
 	
-	if (!db)
+	if (!db || !plan || size == 0)
+		return -1;
+	
+	order = query_order(filter);
+	if (!order)
+		return -1;
+	
+	build_where_clause(filter, where, sizeof(where), &qp);
+	*plan = '\0';
+	
+	pthread_mutex_lock(&db->lock);
+	
+	if (db->num_partitions > 0 && strcmp(order, "timestamp") != 0) {
+		query = union_query(db, filter, order, where, &qp);
+	} else {
+		/* First table the query would read */
+		n = num_tables(db);
+		for (size_t j = 0; !query && j < n; j++) {
+			size_t i = filter && filter->descending ? n - 1 - j : j;
+			int64_t limit = filter && filter->limit > 0 ?
+			                (int64_t)(filter->limit + filter->offset) : -1;
+			struct query_params table_qp = qp;
+			
+			if (table_selected(db, i, filter) &&
+			    table_query(db, i, filter, order, where, limit, &table_qp, sql, sizeof(sql))) {
+				query = strdup(sql);
+				qp = table_qp;
+			}
+		}
+	}
+	
+	if (!query) {
+		pthread_mutex_unlock(&db->lock);
 		return -1;
+	}
 	
-	build_where_clause(filter, where, sizeof(where));
-	snprintf(sql, sizeof(sql), "SELECT COUNT(*) FROM events %s", where);
+	n = strlen(query) + 32;
+	char *explain = malloc(n);
+	if (!explain) {
+		free(query);
+		pthread_mutex_unlock(&db->lock);
+		return -1;
+	}
+	snprintf(explain, n, "EXPLAIN QUERY PLAN %s", query);
+	free(query);
 	
-	rc = sqlite3_prepare_v2(db->db, sql, -1, &stmt, NULL);
+	rc = sqlite3_prepare_v2(db->db, explain, -1, &stmt, NULL);
+	free(explain);
 	if (rc != SQLITE_OK) {
-		fprintf(stderr, "Failed to prepare count query: %s\n", sqlite3_errmsg(db->db));
+		fprintf(stderr, "Failed to explain query: %s\n", sqlite3_errmsg(db->db));
+		pthread_mutex_unlock(&db->lock);
 		return -1;
 	}
 	
-	if (sqlite3_step(stmt) == SQLITE_ROW) {
-		count = sqlite3_column_int(stmt, 0);
+	bind_params(stmt, &qp);
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		const char *detail = (const char *)sqlite3_column_text(stmt, 3);
+		
+		if (detail && len < size)
+			len += snprintf(plan + len, size - len, "%s\n", detail);
 	}
 	
 	sqlite3_finalize(stmt);
+	pthread_mutex_unlock(&db->lock);
 	
-	return count;
+	return (int)(len < size ? len : size - 1);
+}
+
+/* Return the pages of dropped partitions to the file system */
+static void partitions_dropped(struct storage_db *db)
+{
+	update_view(db);
+	if (db->incremental_vacuum)
+		exec_sql(db, "PRAGMA incremental_vacuum", "vacuum dropped partitions");
 }
 
 int storage_db_delete_before(struct storage_db *db, uint64_t timestamp)
 {
 	char sql[256];
-	int rc;
+	char name[32];
+	int64_t n;
+	int rc, changes = 0;
+	size_t dropped = 0;
 	
 	if (!db)
 		return -1;
 	
-	snprintf(sql, sizeof(sql), "DELETE FROM events WHERE timestamp < %lu", timestamp);
+	pthread_mutex_lock(&db->lock);
+	
+	/* Partitions wholly before timestamp are dropped */
+	while (db->num_partitions > 0 && db->partition_span &&
+	       db->partitions[0].id < timestamp / db->partition_span) {
+		table_name(db, 1, name, sizeof(name));
+		n = table_count(db, name, "", NULL);
+		if (n < 0 || !partition_drop(db, 0))
+			break;
+		changes += (int)n;
+		dropped++;
+	}
 	
-	rc = sqlite3_exec(db->db, sql, NULL, NULL, NULL);
-	if (rc != SQLITE_OK) {
-		fprintf(stderr, "Failed to delete events: %s\n", sqlite3_errmsg(db->db));
-		return -1;
+	if (dropped)
+		partitions_dropped(db);
+	
+	/* Cut the unpartitioned table and the partition of timestamp */
+	for (size_t i = 0; i < num_tables(db); i++) {
+		if (i > 0 && db->partition_span &&
+		    db->partitions[i - 1].id * db->partition_span >= timestamp)
+			break;
+		
+		table_name(db, i, name, sizeof(name));
+		snprintf(sql, sizeof(sql), "DELETE FROM %s WHERE timestamp < %lu", name, timestamp);
+		
+		rc = sqlite3_exec(db->db, sql, NULL, NULL, NULL);
+		if (rc != SQLITE_OK) {
+			fprintf(stderr, "Failed to delete events: %s\n", sqlite3_errmsg(db->db));
+			pthread_mutex_unlock(&db->lock);
+			return -1;
+		}
+		
+		changes += sqlite3_changes(db->db);
 	}
 	
-	return sqlite3_changes(db->db);
+	pthread_mutex_unlock(&db->lock);
+	
+	return changes;
 }
 
 int storage_db_delete_oldest(struct storage_db *db, size_t keep_count)
 {
 	char sql[256];
-	int rc;
+	char name[32];
+	int64_t n;
+	int rc, changes = 0;
+	size_t dropped = 0;
 	
 	if (!db)
 		return -1;
 	
-	snprintf(sql, sizeof(sql),
-	        "DELETE FROM events WHERE id IN ("
-	        "  SELECT id FROM events ORDER BY timestamp DESC LIMIT -1 OFFSET %zu"
-	        ")", keep_count);
+	pthread_mutex_lock(&db->lock);
 	
-	rc = sqlite3_exec(db->db, sql, NULL, NULL, NULL);
-	if (rc != SQLITE_OK) {
-		fprintf(stderr, "Failed to delete oldest events: %s\n", sqlite3_errmsg(db->db));
-		return -1;
+	/* Keep the newest tables holding keep_count events, drop the older */
+	for (size_t i = num_tables(db); i-- > 0;) {
+		table_name(db, i, name, sizeof(name));
+		
+		if (keep_count > 0) {
+			n = table_count(db, name, "", NULL);
+			if (n < 0) {
+				pthread_mutex_unlock(&db->lock);
+				return -1;
+			}
+			if ((uint64_t)n <= keep_count) {
+				keep_count -= (size_t)n;
+				continue;
+			}
+		} else if (i > 0) {
+			n = table_count(db, name, "", NULL);
+			if (n >= 0 && partition_drop(db, i - 1)) {
+				changes += (int)n;
+				dropped++;
+				continue;
+			}
+		}
+		
+		snprintf(sql, sizeof(sql),
+		        "DELETE FROM %1$s WHERE id IN ("
+		        "  SELECT id FROM %1$s ORDER BY timestamp DESC LIMIT -1 OFFSET %2$zu"
+		        ")", name, keep_count);
+		keep_count = 0;
+		
+		rc = sqlite3_exec(db->db, sql, NULL, NULL, NULL);
+		if (rc != SQLITE_OK) {
+			fprintf(stderr, "Failed to delete oldest events: %s\n", sqlite3_errmsg(db->db));
+			if (dropped)
+				partitions_dropped(db);
+			pthread_mutex_unlock(&db->lock);
+			return -1;
+		}
+		
+		changes += sqlite3_changes(db->db);
 	}
 	
-	return sqlite3_changes(db->db);
+	if (dropped)
+		partitions_dropped(db);
+	
+	pthread_mutex_unlock(&db->lock);
+	
+	return changes;
 }
 
 bool storage_db_vacuum(struct storage_db *db)
@@ -488,7 +2018,14 @@ bool storage_db_vacuum(struct storage_db *db)
 	if (!db)
 		return false;
 	
+	pthread_mutex_lock(&db->lock);
+	
+	/* VACUUM cannot run inside the batch transaction */
+	commit_transaction(db);
+	
 	rc = sqlite3_exec(db->db, "VACUUM", NULL, NULL, NULL);
+	pthread_mutex_unlock(&db->lock);
+	
 	if (rc != SQLITE_OK) {
 		fprintf(stderr, "Failed to vacuum database: %s\n", sqlite3_errmsg(db->db));
 		return false;
@@ -497,6 +2034,66 @@ bool storage_db_vacuum(struct storage_db *db)
 	return true;
 }
 
+int storage_db_incremental_vacuum(struct storage_db *db, unsigned int max_pages)
+{
+	char sql[64];
+	int64_t before, after;
+	int rc;
+	
+	if (!db)
+		return -1;
+	
+	if (!db->incremental_vacuum)
+		return 0;
+	
+	pthread_mutex_lock(&db->lock);
+	
+	/* Pages freed by the batch transaction only count once committed */
+	commit_transaction(db);
+	
+	before = query_int(db->db, "PRAGMA freelist_count");
+	snprintf(sql, sizeof(sql), "PRAGMA incremental_vacuum(%u)", max_pages);
+	rc = sqlite3_exec(db->db, sql, NULL, NULL, NULL);
+	after = query_int(db->db, "PRAGMA freelist_count");
+	
+	pthread_mutex_unlock(&db->lock);
+	
+	if (rc != SQLITE_OK || before < 0 || after < 0) {
+		fprintf(stderr, "Failed to vacuum database incrementally: %s\n",
+		        sqlite3_errmsg(db->db));
+		return -1;
+	}
+	
+	return before > after ? (int)(before - after) : 0;
+}
+
+bool storage_db_wal_checkpoint(struct storage_db *db, int *wal_frames,
+                               int *checkpointed_frames)
+{
+	int log = 0, ckpt = 0;
+	int rc;
+	
+	if (!db)
+		return false;
+	
+	pthread_mutex_lock(&db->lock);
+	rc = sqlite3_wal_checkpoint_v2(db->db, NULL, SQLITE_CHECKPOINT_PASSIVE, &log, &ckpt);
+	pthread_mutex_unlock(&db->lock);
+	
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "Failed to checkpoint WAL: %s\n", sqlite3_errmsg(db->db));
+		return false;
+	}
+	
+	/* Both are -1 without WAL */
+	if (wal_frames)
+		*wal_frames = log > 0 ? log : 0;
+	if (checkpointed_frames)
+		*checkpointed_frames = ckpt > 0 ? ckpt : 0;
+	
+	return true;
+}
+
 bool storage_db_analyze(struct storage_db *db)
 {
 	int rc;
@@ -504,7 +2101,10 @@ bool storage_db_analyze(struct storage_db *db)
 	if (!db)
 		return false;
 	
+	pthread_mutex_lock(&db->lock);
 	rc = sqlite3_exec(db->db, "ANALYZE", NULL, NULL, NULL);
+	pthread_mutex_unlock(&db->lock);
+	
 	if (rc != SQLITE_OK) {
 		fprintf(stderr, "Failed to analyze database: %s\n", sqlite3_errmsg(db->db));
 		return false;
@@ -525,14 +2125,19 @@ bool storage_db_get_stats(struct storage_db *db,
 	if (!db)
 		return false;
 	
+	pthread_mutex_lock(&db->lock);
+	
 	/* Get total events */
 	if (total_events) {
-		rc = sqlite3_prepare_v2(db->db, "SELECT COUNT(*) FROM events", -1, &stmt, NULL);
-		if (rc == SQLITE_OK) {
-			if (sqlite3_step(stmt) == SQLITE_ROW) {
-				*total_events = sqlite3_column_int64(stmt, 0);
-			}
-			sqlite3_finalize(stmt);
+		*total_events = 0;
+		for (size_t i = 0; i < num_tables(db); i++) {
+			char name[32];
+			int64_t n;
+			
+			table_name(db, i, name, sizeof(name));
+			n = table_count(db, name, "", NULL);
+			if (n > 0)
+				*total_events += (uint64_t)n;
 		}
 	}
 	
@@ -547,6 +2152,8 @@ bool storage_db_get_stats(struct storage_db *db,
 		}
 	}
 	
+	pthread_mutex_unlock(&db->lock);
+	
 	/* Get file size */
 	if (db_size_bytes) {
 		const char *db_path = sqlite3_db_filename(db->db, "main");
@@ -2,28 +2,460 @@
  *
  * Provides a unified interface to all storage backends with
  * coordinated event storage and management.
+ *
+ * Pipelined layers give the database, the segment log and the audit log
+ * a stage each: a bounded queue and a thread that writes what it takes
+ * from it in batches. The memory buffer is still written on the caller,
+ * so queries see an event at once. Events are numbered in one order for
+ * all stages. A stage flushes its backend whenever its queue drains, and
+ * then marks everything it wrote as durable, which turns a burst into
+ * one commit or fdatasync per stage. Callers that need an event on disk
+ * wait for the durable sequence to reach it.
+ *
+ * Sampled backends get events through a sampler, on their stage or,
+ * without a pipeline, under a lock of the samplers. An event stored with
+ * a weight is a copy with sample_weight set, the event itself is shared.
  */
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <errno.h>
 #include "storage_layer.h"
 #include "storage_buffer.h"
 #include "storage_db.h"
+#include "storage_log.h"
 #include "audit_log.h"
 #include "retention_policy.h"
 #include "event_processor.h"
+#include "stats_bus.h"
+
+/* Pipeline defaults */
+#define DEFAULT_STAGE_QUEUE_SIZE 4096
+#define STAGE_CHUNK 256                 /* Events taken per hold of the queue lock */
+#define STAGE_FLUSH_EVENTS 4096         /* Flush this often when the queue never drains */
+#define STAGE_RETRY_MS 100              /* Wait before retrying a failed flush */
+#define STAGE_TICK_MS 100               /* Idle wakeups of stages with a sampling reservoir */
+
+/* Backends with a stage, in the order they are written synchronously */
+#define MAX_STAGES 3
+
+struct storage_layer;
+
+/* Queued event with its sequence */
+struct stage_item {
+	struct nlmon_event *event;
+	uint64_t sequence;
+	bool security;
+};
+
+/* Writer of one backend */
+struct storage_stage {
+	struct storage_layer *sl;
+	const char *name;
+	bool (*write)(struct storage_layer *sl, struct nlmon_event *event, bool security);
+	bool (*flush)(struct storage_layer *sl);
+	struct event_sampler *sampler;  /* Used by the stage thread only */
+	
+	pthread_mutex_t lock;
+	pthread_cond_t wake;            /* Events queued or stopping */
+	pthread_cond_t room;            /* Events taken */
+	struct stage_item *items;       /* Circular queue */
+	size_t size;
+	size_t first;
+	size_t count;
+	bool running;
+	pthread_t thread;
+	
+	/* Statistics, under lock */
+	uint64_t written;
+	uint64_t failed;
+	uint64_t sampled;
+	uint64_t flushes;
+	uint64_t flush_failures;
+	uint64_t stalls;
+	
+	uint64_t durable;               /* Under the layer's durable_lock */
+};
 
 /* Storage layer structure */
 struct storage_layer {
 	struct storage_buffer *buffer;
+	struct storage_rollup *rollup;
 	struct storage_db *db;
+	struct storage_log *log;
 	struct audit_log *audit;
 	struct retention_policy *retention;
 	
+	/* Samplers of the database and the segment log */
+	struct event_sampler *db_sampler;
+	struct event_sampler *log_sampler;
+	pthread_mutex_t sample_lock;    /* Without a pipeline */
+	
+	/* Pipeline, no stages unless pipelined */
+	struct storage_stage stages[MAX_STAGES];
+	size_t num_stages;
+	pthread_mutex_t submit_lock;    /* Queues every event in sequence order */
+	_Atomic uint64_t sequence;      /* Last stored event */
+	pthread_mutex_t durable_lock;
+	pthread_cond_t durable_changed;
+	uint64_t durable;               /* Without stages, flushed up to */
+	uint64_t flush_failures;        /* Failed stage flushes, under durable_lock */
+	_Atomic uint64_t wanted;        /* Highest sequence waited for */
+	
 	struct storage_layer_config config;
 };
 
+static bool db_write(struct storage_layer *sl, struct nlmon_event *event, bool security)
+{
+	if (!storage_db_insert(sl->db, event))
+		return false;
+	
+	/* Rough row size, retention only weighs slices against each other */
+	if (sl->retention)
+		retention_policy_account(sl->retention, event->timestamp,
+		                         sizeof(*event) + event->data_size + event->raw_msg_len);
+	return true;
+}
+
+static bool db_flush(struct storage_layer *sl)
+{
+	return storage_db_flush(sl->db);
+}
+
+static bool log_write(struct storage_layer *sl, struct nlmon_event *event, bool security)
+{
+	return storage_log_append(sl->log, event);
+}
+
+static bool log_flush(struct storage_layer *sl)
+{
+	return storage_log_flush(sl->log);
+}
+
+static bool audit_write(struct storage_layer *sl, struct nlmon_event *event, bool security)
+{
+	return audit_log_write(sl->audit, event, security ? AUDIT_SECURITY : AUDIT_INFO, NULL);
+}
+
+static bool audit_flush(struct storage_layer *sl)
+{
+	return audit_log_flush(sl->audit);
+}
+
+/* Where a sampler hands its reservoir events */
+struct sample_write {
+	struct storage_layer *sl;
+	bool (*write)(struct storage_layer *sl, struct nlmon_event *event, bool security);
+	uint64_t written;
+	uint64_t failed;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Write an event that stands for weight events */
+static bool write_weighted(struct sample_write *out, struct nlmon_event *event,
+                           uint32_t weight, bool security)
+{
+	struct nlmon_event copy;
+	uint64_t total;
+	
+	if (weight == 1)
+		return out->write(out->sl, event, security);
+	
+	total = (uint64_t)nlmon_event_weight(event) * weight;
+	copy = *event;
+	copy.sample_weight = total > UINT32_MAX ? UINT32_MAX : (uint32_t)total;
+	return out->write(out->sl, &copy, security);
+}
+
+static void write_held(struct nlmon_event *event, uint32_t weight, void *arg)
+{
+	struct sample_write *out = arg;
+	
+	if (write_weighted(out, event, weight, false))
+		out->written++;
+	else
+		out->failed++;
+}
+
+/* Sample an event and write it if kept, false if the backend failed */
+static bool write_sampled(struct event_sampler *sampler, struct sample_write *out,
+                          struct nlmon_event *event, bool security, bool *kept)
+{
+	uint32_t weight = 1;
+	
+	if (sampler)
+		weight = event_sampler_offer(sampler, event, now_ns(), write_held, out);
+	*kept = weight > 0;
+	return weight == 0 || write_weighted(out, event, weight, security);
+}
+
+/* Store an event in a backend without a stage */
+static bool store_sampled(struct storage_layer *sl, struct event_sampler *sampler,
+                          bool (*write)(struct storage_layer *, struct nlmon_event *, bool),
+                          struct nlmon_event *event, bool security)
+{
+	struct sample_write out = { .sl = sl, .write = write };
+	bool ok, kept;
+	
+	if (!sampler)
+		return write(sl, event, security);
+	
+	pthread_mutex_lock(&sl->sample_lock);
+	ok = write_sampled(sampler, &out, event, security, &kept) && out.failed == 0;
+	pthread_mutex_unlock(&sl->sample_lock);
+	return ok;
+}
+
+/* Lowest sequence every stage has flushed, durable_lock held */
+static uint64_t durable_sequence(struct storage_layer *sl)
+{
+	uint64_t durable;
+	
+	if (sl->num_stages == 0)
+		return sl->durable;
+	
+	durable = sl->stages[0].durable;
+	for (size_t i = 1; i < sl->num_stages; i++) {
+		if (sl->stages[i].durable < durable)
+			durable = sl->stages[i].durable;
+	}
+	return durable;
+}
+
+static void deadline_after(struct timespec *ts, uint32_t ms)
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+/* Stage thread, writes queued events and flushes when the queue drains */
+static void *stage_thread(void *arg)
+{
+	struct storage_stage *st = arg;
+	struct storage_layer *sl = st->sl;
+	struct stage_item batch[STAGE_CHUNK];
+	uint64_t written = 0, unflushed = 0;
+	bool timed = event_sampler_holds(st->sampler);
+	
+	pthread_mutex_lock(&st->lock);
+	
+	for (;;) {
+		struct sample_write out = { .sl = sl, .write = st->write };
+		uint64_t ok_count = 0, failed = 0, sampled = 0;
+		size_t n = 0;
+		bool drained, stop, flushed = false, flush_ok = true;
+		
+		/* Reservoirs close their intervals while no events come */
+		while (st->count == 0 && st->running && unflushed == 0) {
+			struct timespec ts;
+			
+			if (!timed) {
+				pthread_cond_wait(&st->wake, &st->lock);
+				continue;
+			}
+			deadline_after(&ts, STAGE_TICK_MS);
+			if (pthread_cond_timedwait(&st->wake, &st->lock, &ts) == ETIMEDOUT)
+				break;
+		}
+		
+		while (n < STAGE_CHUNK && st->count > 0) {
+			batch[n++] = st->items[st->first];
+			st->first = (st->first + 1) % st->size;
+			st->count--;
+		}
+		if (n > 0)
+			pthread_cond_broadcast(&st->room);
+		drained = st->count == 0;
+		stop = !st->running && drained;
+		
+		pthread_mutex_unlock(&st->lock);
+		
+		for (size_t i = 0; i < n; i++) {
+			bool kept;
+			
+			if (!write_sampled(st->sampler, &out, batch[i].event, batch[i].security, &kept))
+				failed++;
+			else if (kept)
+				ok_count++;
+			else
+				sampled++;
+			nlmon_event_put(batch[i].event);
+			written = batch[i].sequence;
+		}
+		
+		/* Held events go on shutdown, or when their interval ends */
+		if (stop)
+			event_sampler_drain(st->sampler, write_held, &out);
+		else if (timed)
+			event_sampler_tick(st->sampler, now_ns(), write_held, &out);
+		ok_count += out.written;
+		failed += out.failed;
+		unflushed += n + out.written + out.failed;
+		
+		/* Counted before the events can show as durable */
+		pthread_mutex_lock(&st->lock);
+		st->written += ok_count;
+		st->failed += failed;
+		st->sampled += sampled;
+		pthread_mutex_unlock(&st->lock);
+		
+		/* Group flush on drain, on a waiter or after a long run */
+		if (unflushed > 0 &&
+		    (drained || unflushed >= STAGE_FLUSH_EVENTS ||
+		     atomic_load_explicit(&sl->wanted, memory_order_relaxed) > st->durable)) {
+			flushed = true;
+			flush_ok = st->flush(sl);
+			
+			pthread_mutex_lock(&sl->durable_lock);
+			if (flush_ok) {
+				st->durable = written;
+				unflushed = 0;
+			} else {
+				sl->flush_failures++;
+			}
+			pthread_cond_broadcast(&sl->durable_changed);
+			pthread_mutex_unlock(&sl->durable_lock);
+		}
+		
+		pthread_mutex_lock(&st->lock);
+		
+		if (flushed) {
+			st->flushes++;
+			if (!flush_ok)
+				st->flush_failures++;
+		}
+		
+		if (stop)
+			break;
+		
+		/* Back off before flushing a failing backend again */
+		if (!flush_ok && st->count == 0) {
+			struct timespec ts;
+			
+			deadline_after(&ts, STAGE_RETRY_MS);
+			pthread_cond_timedwait(&st->wake, &st->lock, &ts);
+		}
+	}
+	
+	pthread_mutex_unlock(&st->lock);
+	
+	return NULL;
+}
+
+/* Queue an event for a stage, waiting for room, submit_lock held */
+static bool stage_push(struct storage_stage *st, const struct stage_item *item)
+{
+	pthread_mutex_lock(&st->lock);
+	
+	/* Backpressure rather than loss, the audit chain must not have gaps */
+	if (st->count == st->size && st->running) {
+		st->stalls++;
+		while (st->count == st->size && st->running)
+			pthread_cond_wait(&st->room, &st->lock);
+	}
+	
+	if (!st->running) {
+		pthread_mutex_unlock(&st->lock);
+		return false;
+	}
+	
+	st->items[(st->first + st->count) % st->size] = *item;
+	if (st->count++ == 0)
+		pthread_cond_signal(&st->wake);
+	
+	pthread_mutex_unlock(&st->lock);
+	
+	return true;
+}
+
+static int stage_start(struct storage_layer *sl, const char *name,
+                       bool (*write)(struct storage_layer *, struct nlmon_event *, bool),
+                       bool (*flush)(struct storage_layer *), struct event_sampler *sampler)
+{
+	struct storage_stage *st = &sl->stages[sl->num_stages];
+	size_t size = sl->config.pipeline_queue_size > 0 ?
+	              sl->config.pipeline_queue_size : DEFAULT_STAGE_QUEUE_SIZE;
+	
+	memset(st, 0, sizeof(*st));
+	st->sl = sl;
+	st->name = name;
+	st->write = write;
+	st->flush = flush;
+	st->sampler = sampler;
+	st->size = size;
+	st->running = true;
+	
+	st->items = calloc(size, sizeof(*st->items));
+	if (!st->items)
+		return -1;
+	if (pthread_mutex_init(&st->lock, NULL) != 0)
+		goto fail_items;
+	if (pthread_cond_init(&st->wake, NULL) != 0)
+		goto fail_lock;
+	if (pthread_cond_init(&st->room, NULL) != 0)
+		goto fail_wake;
+	if (pthread_create(&st->thread, NULL, stage_thread, st) != 0)
+		goto fail_room;
+	
+	sl->num_stages++;
+	return 0;
+	
+fail_room:
+	pthread_cond_destroy(&st->room);
+fail_wake:
+	pthread_cond_destroy(&st->wake);
+fail_lock:
+	pthread_mutex_destroy(&st->lock);
+fail_items:
+	free(st->items);
+	return -1;
+}
+
+/* Stop a stage after it wrote and flushed what is queued */
+static void stage_stop(struct storage_stage *st)
+{
+	pthread_mutex_lock(&st->lock);
+	st->running = false;
+	pthread_cond_broadcast(&st->wake);
+	pthread_cond_broadcast(&st->room);
+	pthread_mutex_unlock(&st->lock);
+	
+	pthread_join(st->thread, NULL);
+	
+	pthread_cond_destroy(&st->room);
+	pthread_cond_destroy(&st->wake);
+	pthread_mutex_destroy(&st->lock);
+	free(st->items);
+}
+
+/* Start a stage per enabled backend */
+static int pipeline_start(struct storage_layer *sl)
+{
+	if (sl->db && stage_start(sl, "database", db_write, db_flush, sl->db_sampler) < 0)
+		return -1;
+	if (sl->log && stage_start(sl, "log", log_write, log_flush, sl->log_sampler) < 0)
+		return -1;
+	if (sl->audit && stage_start(sl, "audit", audit_write, audit_flush, NULL) < 0)
+		return -1;
+	return 0;
+}
+
 struct storage_layer *storage_layer_create(struct storage_layer_config *config)
 {
 	struct storage_layer *sl;
@@ -36,25 +468,56 @@ struct storage_layer *storage_layer_create(struct storage_layer_config *config)
 		return NULL;
 	
 	sl->config = *config;
+	atomic_init(&sl->sequence, 0);
+	atomic_init(&sl->wanted, 0);
+	if (pthread_mutex_init(&sl->submit_lock, NULL) != 0)
+		goto fail;
+	if (pthread_mutex_init(&sl->durable_lock, NULL) != 0)
+		goto fail_submit;
+	if (pthread_cond_init(&sl->durable_changed, NULL) != 0)
+		goto fail_durable;
+	if (pthread_mutex_init(&sl->sample_lock, NULL) != 0)
+		goto fail_changed;
 	
 	/* Create memory buffer if enabled */
 	if (config->enable_buffer) {
-		sl->buffer = storage_buffer_create(config->buffer_capacity);
+		if (config->buffer_indexed)
+			sl->buffer = storage_buffer_create_indexed(config->buffer_capacity);
+		else
+			sl->buffer = storage_buffer_create(config->buffer_capacity);
 		if (!sl->buffer) {
 			fprintf(stderr, "Failed to create storage buffer\n");
 			storage_layer_destroy(sl);
 			return NULL;
 		}
+		if (config->buffer_history_bytes)
+			storage_buffer_set_history(sl->buffer, config->buffer_history_bytes);
+	}
+	
+	/* Create rollup if enabled */
+	if (config->enable_rollup) {
+		sl->rollup = storage_rollup_create(&config->rollup);
+		if (!sl->rollup) {
+			fprintf(stderr, "Failed to create storage rollup\n");
+			storage_layer_destroy(sl);
+			return NULL;
+		}
 	}
 	
 	/* Create database if enabled */
 	if (config->enable_database && config->db_path) {
+		bool maintenance = config->enable_retention && config->retention_cleanup_interval > 0 &&
+		                   config->retention_maintenance_interval_ms > 0;
 		struct storage_db_config db_config = {
 			.db_path = config->db_path,
 			.batch_size = config->db_batch_size,
 			.cache_size_kb = config->db_cache_size_kb,
 			.enable_wal = config->db_enable_wal,
-			.busy_timeout_ms = 5000
+			.busy_timeout_ms = 5000,
+			.async_writer = config->db_async_writer,
+			.partition_span = config->db_partition_span,
+			/* The retention thread checkpoints between commits instead */
+			.wal_autocheckpoint = maintenance ? -1 : 0
 		};
 		
 		sl->db = storage_db_open(&db_config);
@@ -65,6 +528,22 @@ struct storage_layer *storage_layer_create(struct storage_layer_config *config)
 		}
 	}
 	
+	/* Open segment log if enabled */
+	if (config->enable_log && config->log_dir) {
+		struct storage_log_config log_config = {
+			.dir = config->log_dir,
+			.segment_size = config->log_segment_size,
+			.max_segments = config->log_max_segments
+		};
+		
+		sl->log = storage_log_open(&log_config);
+		if (!sl->log) {
+			fprintf(stderr, "Failed to open segment log\n");
+			storage_layer_destroy(sl);
+			return NULL;
+		}
+	}
+	
 	/* Create audit log if enabled */
 	if (config->enable_audit_log && config->audit_log_path) {
 		struct audit_log_config audit_config = {
@@ -73,7 +552,9 @@ struct storage_layer *storage_layer_create(struct storage_layer_config *config)
 			.max_file_size = config->audit_max_file_size,
 			.max_rotations = config->audit_max_rotations,
 			.sync_writes = config->audit_sync_writes,
-			.verify_on_open = false
+			.verify_on_open = false,
+			.batch_size = config->audit_batch_size,
+			.checkpoint_interval = config->audit_checkpoint_interval
 		};
 		
 		sl->audit = audit_log_open(&audit_config);
@@ -93,7 +574,10 @@ struct storage_layer *storage_layer_create(struct storage_layer_config *config)
 			.cleanup_interval = config->retention_cleanup_interval,
 			.cleanup_on_startup = config->retention_cleanup_on_startup,
 			.delete_oldest_first = true,
-			.batch_delete_size = 1000
+			.batch_delete_size = 1000,
+			.cpus = config->retention_cpus,
+			.maintenance_interval_ms = config->retention_maintenance_interval_ms,
+			.busy_queue_depth = config->retention_busy_queue_depth
 		};
 		
 		sl->retention = retention_policy_create(&retention_config, sl->db, sl->buffer);
@@ -102,6 +586,7 @@ struct storage_layer *storage_layer_create(struct storage_layer_config *config)
 			storage_layer_destroy(sl);
 			return NULL;
 		}
+		retention_policy_set_log(sl->retention, sl->log);
 		
 		/* Start automatic enforcement */
 		if (config->retention_cleanup_interval > 0) {
@@ -109,7 +594,33 @@ struct storage_layer *storage_layer_create(struct storage_layer_config *config)
 		}
 	}
 	
+	/* Samplers before the stages that use them */
+	if ((sl->db && event_sampler_config_active(&config->db_sampling) &&
+	     !(sl->db_sampler = event_sampler_create(&config->db_sampling))) ||
+	    (sl->log && event_sampler_config_active(&config->log_sampling) &&
+	     !(sl->log_sampler = event_sampler_create(&config->log_sampling)))) {
+		fprintf(stderr, "Failed to create storage sampler\n");
+		storage_layer_destroy(sl);
+		return NULL;
+	}
+	
+	if (config->pipelined && pipeline_start(sl) < 0) {
+		fprintf(stderr, "Failed to start storage pipeline\n");
+		storage_layer_destroy(sl);
+		return NULL;
+	}
+	
 	return sl;
+	
+fail_changed:
+	pthread_cond_destroy(&sl->durable_changed);
+fail_durable:
+	pthread_mutex_destroy(&sl->durable_lock);
+fail_submit:
+	pthread_mutex_destroy(&sl->submit_lock);
+fail:
+	free(sl);
+	return NULL;
 }
 
 void storage_layer_destroy(struct storage_layer *sl)
@@ -123,10 +634,29 @@ void storage_layer_destroy(struct storage_layer *sl)
 		retention_policy_destroy(sl->retention);
 	}
 	
+	/* Drain the stages into the backends before closing them */
+	for (size_t i = 0; i < sl->num_stages; i++)
+		stage_stop(&sl->stages[i]);
+	
+	/* Without stages the events held by sampling are written here */
+	if (sl->num_stages == 0) {
+		struct sample_write db_out = { .sl = sl, .write = db_write };
+		struct sample_write log_out = { .sl = sl, .write = log_write };
+		
+		event_sampler_drain(sl->db_sampler, write_held, &db_out);
+		event_sampler_drain(sl->log_sampler, write_held, &log_out);
+	}
+	event_sampler_destroy(sl->db_sampler);
+	event_sampler_destroy(sl->log_sampler);
+	
 	/* Close audit log */
 	if (sl->audit)
 		audit_log_close(sl->audit);
 	
+	/* Close segment log */
+	if (sl->log)
+		storage_log_close(sl->log);
+	
 	/* Close database */
 	if (sl->db)
 		storage_db_close(sl->db);
@@ -134,10 +664,45 @@ void storage_layer_destroy(struct storage_layer *sl)
 	/* Destroy buffer */
 	if (sl->buffer)
 		storage_buffer_destroy(sl->buffer);
+	storage_rollup_destroy(sl->rollup);
 	
+	pthread_mutex_destroy(&sl->sample_lock);
+	pthread_cond_destroy(&sl->durable_changed);
+	pthread_mutex_destroy(&sl->durable_lock);
+	pthread_mutex_destroy(&sl->submit_lock);
 	free(sl);
 }
 
+/* Number the event and queue it for every stage */
+static bool pipeline_submit(struct storage_layer *sl, struct nlmon_event *event, bool security)
+{
+	struct stage_item item = { .security = security };
+	struct nlmon_event *ref;
+	bool ok = true;
+	
+	/* One copy at most, the stages share refcounted events */
+	ref = nlmon_event_share(event);
+	if (!ref)
+		return false;
+	
+	pthread_mutex_lock(&sl->submit_lock);
+	
+	item.sequence = atomic_load_explicit(&sl->sequence, memory_order_relaxed) + 1;
+	for (size_t i = 0; i < sl->num_stages; i++) {
+		item.event = i + 1 < sl->num_stages ? nlmon_event_share(ref) : ref;
+		if (!item.event || !stage_push(&sl->stages[i], &item)) {
+			if (item.event)
+				nlmon_event_put(item.event);
+			ok = false;
+		}
+	}
+	atomic_store_explicit(&sl->sequence, item.sequence, memory_order_release);
+	
+	pthread_mutex_unlock(&sl->submit_lock);
+	
+	return ok;
+}
+
 bool storage_layer_store_event(struct storage_layer *sl,
                                struct nlmon_event *event,
                                bool is_security_event)
@@ -155,6 +720,9 @@ bool storage_layer_store_event(struct storage_layer *sl,
 		}
 	}
 	
+	if (sl->rollup)
+		storage_rollup_add(sl->rollup, event);
+	
 	/* Store in memory buffer */
 	if (sl->buffer) {
 		if (!storage_buffer_add(sl->buffer, event)) {
@@ -163,14 +731,31 @@ bool storage_layer_store_event(struct storage_layer *sl,
 		}
 	}
 	
+	if (sl->num_stages > 0) {
+		if (!pipeline_submit(sl, event, is_security_event))
+			success = false;
+		if (success)
+			nlmon_trace_stamp(&event->trace, NLMON_TRACE_STORAGE);
+		return success;
+	}
+	atomic_fetch_add_explicit(&sl->sequence, 1, memory_order_relaxed);
+	
 	/* Store in database */
 	if (sl->db) {
-		if (!storage_db_insert(sl->db, event)) {
+		if (!store_sampled(sl, sl->db_sampler, db_write, event, is_security_event)) {
 			fprintf(stderr, "Failed to insert event into database\n");
 			success = false;
 		}
 	}
 	
+	/* Append to segment log */
+	if (sl->log) {
+		if (!store_sampled(sl, sl->log_sampler, log_write, event, is_security_event)) {
+			fprintf(stderr, "Failed to append event to segment log\n");
+			success = false;
+		}
+	}
+	
 	/* Write to audit log */
 	if (sl->audit) {
 		enum audit_severity severity = is_security_event ? 
@@ -182,6 +767,9 @@ bool storage_layer_store_event(struct storage_layer *sl,
 		}
 	}
 	
+	if (success)
+		nlmon_trace_stamp(&event->trace, NLMON_TRACE_STORAGE);
+	
 	return success;
 }
 
@@ -190,11 +778,21 @@ struct storage_buffer *storage_layer_get_buffer(struct storage_layer *sl)
 	return sl ? sl->buffer : NULL;
 }
 
+struct storage_rollup *storage_layer_get_rollup(struct storage_layer *sl)
+{
+	return sl ? sl->rollup : NULL;
+}
+
 struct storage_db *storage_layer_get_database(struct storage_layer *sl)
 {
 	return sl ? sl->db : NULL;
 }
 
+struct storage_log *storage_layer_get_log(struct storage_layer *sl)
+{
+	return sl ? sl->log : NULL;
+}
+
 struct audit_log *storage_layer_get_audit_log(struct storage_layer *sl)
 {
 	return sl ? sl->audit : NULL;
@@ -203,10 +801,29 @@ struct audit_log *storage_layer_get_audit_log(struct storage_layer *sl)
 bool storage_layer_flush(struct storage_layer *sl)
 {
 	bool success = true;
+	uint64_t sequence;
 	
 	if (!sl)
 		return false;
 	
+	/* The stages flush the backends themselves */
+	if (sl->num_stages > 0)
+		return storage_layer_wait_durable(sl, storage_layer_sequence(sl), -1);
+	sequence = atomic_load_explicit(&sl->sequence, memory_order_acquire);
+	
+	/* Write what sampling holds */
+	if (sl->db_sampler || sl->log_sampler) {
+		struct sample_write db_out = { .sl = sl, .write = db_write };
+		struct sample_write log_out = { .sl = sl, .write = log_write };
+		
+		pthread_mutex_lock(&sl->sample_lock);
+		event_sampler_drain(sl->db_sampler, write_held, &db_out);
+		event_sampler_drain(sl->log_sampler, write_held, &log_out);
+		pthread_mutex_unlock(&sl->sample_lock);
+		if (db_out.failed || log_out.failed)
+			success = false;
+	}
+	
 	/* Flush database */
 	if (sl->db) {
 		if (!storage_db_flush(sl->db)) {
@@ -215,9 +832,126 @@ bool storage_layer_flush(struct storage_layer *sl)
 		}
 	}
 	
+	/* Flush segment log */
+	if (sl->log) {
+		if (!storage_log_flush(sl->log)) {
+			fprintf(stderr, "Failed to flush segment log\n");
+			success = false;
+		}
+	}
+	
+	/* Flush audit log */
+	if (sl->audit) {
+		if (!audit_log_flush(sl->audit)) {
+			fprintf(stderr, "Failed to flush audit log\n");
+			success = false;
+		}
+	}
+	
+	if (success) {
+		pthread_mutex_lock(&sl->durable_lock);
+		if (sequence > sl->durable)
+			sl->durable = sequence;
+		pthread_mutex_unlock(&sl->durable_lock);
+	}
+	
 	return success;
 }
 
+uint64_t storage_layer_sequence(struct storage_layer *sl)
+{
+	return sl ? atomic_load_explicit(&sl->sequence, memory_order_acquire) : 0;
+}
+
+uint64_t storage_layer_durable_sequence(struct storage_layer *sl)
+{
+	uint64_t durable;
+	
+	if (!sl)
+		return 0;
+	
+	pthread_mutex_lock(&sl->durable_lock);
+	durable = durable_sequence(sl);
+	pthread_mutex_unlock(&sl->durable_lock);
+	
+	return durable;
+}
+
+bool storage_layer_wait_durable(struct storage_layer *sl, uint64_t sequence, int timeout_ms)
+{
+	struct timespec deadline;
+	uint64_t wanted, failures;
+	bool durable;
+	
+	if (!sl)
+		return false;
+	
+	/* Without stages, flush on the caller */
+	if (sl->num_stages == 0) {
+		if (storage_layer_durable_sequence(sl) >= sequence)
+			return true;
+		return storage_layer_flush(sl) && storage_layer_durable_sequence(sl) >= sequence;
+	}
+	
+	/* Ask stages busy with a long run to flush early */
+	wanted = atomic_load_explicit(&sl->wanted, memory_order_relaxed);
+	while (wanted < sequence &&
+	       !atomic_compare_exchange_weak_explicit(&sl->wanted, &wanted, sequence,
+	                                              memory_order_relaxed, memory_order_relaxed))
+		;
+	
+	if (timeout_ms >= 0)
+		deadline_after(&deadline, (uint32_t)timeout_ms);
+	
+	pthread_mutex_lock(&sl->durable_lock);
+	
+	/* A failed flush ends the wait, the stage retries on its own */
+	failures = sl->flush_failures;
+	while (durable_sequence(sl) < sequence && sl->flush_failures == failures) {
+		if (timeout_ms < 0)
+			pthread_cond_wait(&sl->durable_changed, &sl->durable_lock);
+		else if (pthread_cond_timedwait(&sl->durable_changed, &sl->durable_lock,
+		                                &deadline) != 0)
+			break;
+	}
+	durable = durable_sequence(sl) >= sequence;
+	
+	pthread_mutex_unlock(&sl->durable_lock);
+	
+	return durable;
+}
+
+size_t storage_layer_get_stage_stats(struct storage_layer *sl,
+                                     struct storage_stage_stats *stats, size_t max)
+{
+	size_t n;
+	
+	if (!sl || !stats)
+		return 0;
+	
+	n = sl->num_stages < max ? sl->num_stages : max;
+	for (size_t i = 0; i < n; i++) {
+		struct storage_stage *st = &sl->stages[i];
+		
+		pthread_mutex_lock(&st->lock);
+		stats[i].name = st->name;
+		stats[i].written = st->written;
+		stats[i].failed = st->failed;
+		stats[i].sampled = st->sampled;
+		stats[i].flushes = st->flushes;
+		stats[i].flush_failures = st->flush_failures;
+		stats[i].stalls = st->stalls;
+		stats[i].queue_depth = st->count;
+		pthread_mutex_unlock(&st->lock);
+		
+		pthread_mutex_lock(&sl->durable_lock);
+		stats[i].durable = st->durable;
+		pthread_mutex_unlock(&sl->durable_lock);
+	}
+	
+	return n;
+}
+
 int storage_layer_enforce_retention(struct storage_layer *sl)
 {
 	if (!sl || !sl->retention)
@@ -256,3 +990,13 @@ bool storage_layer_get_stats(struct storage_layer *sl,
 	
 	return true;
 }
+
+void storage_layer_collect_stats(struct nlmon_stats_snapshot *snapshot, void *ctx)
+{
+	if (storage_layer_get_stats(ctx, &snapshot->storage.buffer_size,
+	                            &snapshot->storage.buffer_capacity,
+	                            &snapshot->storage.db_event_count,
+	                            &snapshot->storage.db_size_bytes,
+	                            &snapshot->storage.audit_entries))
+		snapshot->have |= STATS_HAVE_STORAGE;
+}
@@ -0,0 +1,963 @@
+/* storage_log.c - Append-only segment log implementation
+ *
+ * Segment files are named <id>.seg with ids counting up in hex, and are
+ * preallocated to the segment size. A segment starts with a header and
+ * its records follow 8-byte aligned. Sealing writes the block index
+ * after the last record, then the header fields locating it, then the
+ * sealed flag. An unsealed segment ends at the first record failing its
+ * CRC; its unused space is zero and never passes.
+ *
+ * Appends are serialized by the log lock and publish the segment's end
+ * with release ordering once the record is written, so cursors read up
+ * to the end they acquire without locking. The log references the
+ * segments it lists and each cursor the segment it reads; the last
+ * reference unmaps a segment, its file is unlinked when it is deleted.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "storage_log.h"
+#include "event_processor.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define SEGMENT_MAGIC "NLMLOG1"
+#define SEGMENT_VERSION 1
+#define SEGMENT_SEALED 0x1
+
+/* Smallest segment accepted */
+#define MIN_SEGMENT_SIZE (64 * 1024)
+
+/* Initial block index capacity of a segment */
+#define INITIAL_BLOCKS 64
+
+#define ALIGN8(x) (((x) + 7) & ~(size_t)7)
+
+/* Header at the start of each segment file */
+struct segment_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint64_t size;                  /* File size */
+	uint64_t end;                   /* Sealed: end of the records */
+	uint64_t index_offset;          /* Sealed: offset of the block index */
+	uint64_t num_blocks;            /* Sealed: entries of the block index */
+	uint64_t records;               /* Sealed: records in the segment */
+	uint64_t reserved;
+};
+
+/* Sparse index entry for index_interval records from offset */
+struct segment_block {
+	uint64_t offset;
+	uint64_t min_ts;
+	uint64_t max_ts;
+};
+
+/* Mapped segment file */
+struct log_segment {
+	uint64_t id;
+	int fd;
+	uint8_t *map;
+	size_t size;
+	atomic_size_t end;              /* End of the records, published after writing */
+	atomic_uint refs;
+	
+	/* Guarded by the log lock */
+	struct segment_block *blocks;
+	size_t num_blocks;
+	size_t max_blocks;
+	uint64_t records;
+	uint64_t min_ts;
+	uint64_t max_ts;
+	struct log_segment *next;       /* Next newer segment */
+};
+
+/* Segment log structure */
+struct storage_log {
+	char *dir;
+	size_t segment_size;
+	size_t max_segments;
+	uint32_t index_interval;
+	bool sync_on_roll;
+	
+	pthread_mutex_t lock;           /* Serializes appends and the segment list */
+	struct log_segment *oldest;
+	struct log_segment *active;     /* Newest segment, the one appended to */
+	size_t num_segments;
+	uint64_t next_id;
+	
+	struct storage_log_stats stats; /* Guarded by lock */
+};
+
+/* Segment log cursor */
+struct storage_log_cursor {
+	struct storage_log *log;
+	struct log_segment *seg;        /* Referenced, NULL between segments */
+	uint64_t last_id;               /* Segment read before, to find the next */
+	size_t offset;
+	uint64_t start_time;
+	uint64_t end_time;
+	bool single;                    /* Read only the segment segment_id */
+	uint64_t segment_id;
+};
+
+static uint32_t crc32c_table[256];
+static uint32_t (*crc32c_update)(uint32_t crc, const void *buf, size_t len);
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	
+	while (len--)
+		crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint64_t crc64 = crc;
+	
+	for (; len >= 8; p += 8, len -= 8) {
+		uint64_t word;
+		
+		memcpy(&word, p, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	
+	crc = (uint32_t)crc64;
+	while (len--)
+		crc = _mm_crc32_u8(crc, *p++);
+	
+	return crc;
+}
+#endif
+
+static void crc32c_init(void)
+{
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		
+		for (int bit = 0; bit < 8; bit++)
+			crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+		crc32c_table[i] = crc;
+	}
+	
+	crc32c_update = crc32c_sw;
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("sse4.2"))
+		crc32c_update = crc32c_hw;
+#endif
+}
+
+/* CRC32C of a record, its length, the header after crc, and its data */
+static uint32_t record_crc(const struct storage_log_record *record)
+{
+	size_t from = offsetof(struct storage_log_record, timestamp);
+	uint32_t crc = ~0u;
+	
+	crc = crc32c_update(crc, &record->length, sizeof(record->length));
+	crc = crc32c_update(crc, (const uint8_t *)record + from,
+	                    sizeof(*record) - from + record->length);
+	
+	return ~crc;
+}
+
+static void segment_path(struct storage_log *log, uint64_t id, char *path, size_t size)
+{
+	snprintf(path, size, "%s/%016" PRIx64 ".seg", log->dir, id);
+}
+
+static struct segment_header *segment_header(struct log_segment *seg)
+{
+	return (struct segment_header *)seg->map;
+}
+
+/* Drop a reference, the last one unmaps the segment */
+static void segment_put(struct log_segment *seg)
+{
+	if (atomic_fetch_sub_explicit(&seg->refs, 1, memory_order_acq_rel) != 1)
+		return;
+	
+	munmap(seg->map, seg->size);
+	close(seg->fd);
+	free(seg->blocks);
+	free(seg);
+}
+
+/* Map segment file fd of size bytes */
+static struct log_segment *segment_map(uint64_t id, int fd, size_t size)
+{
+	struct log_segment *seg;
+	
+	seg = calloc(1, sizeof(*seg));
+	if (!seg)
+		return NULL;
+	
+	seg->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (seg->map == MAP_FAILED) {
+		fprintf(stderr, "Failed to map log segment: %s\n", strerror(errno));
+		free(seg);
+		return NULL;
+	}
+	
+	seg->id = id;
+	seg->fd = fd;
+	seg->size = size;
+	atomic_init(&seg->end, sizeof(struct segment_header));
+	atomic_init(&seg->refs, 1);
+	
+	return seg;
+}
+
+/* Account a record of timestamp ts written at offset */
+static bool segment_note(struct log_segment *seg, uint32_t interval, uint64_t offset, uint64_t ts)
+{
+	struct segment_block *block;
+	
+	if (seg->records % interval == 0) {
+		if (seg->num_blocks == seg->max_blocks) {
+			size_t max = seg->max_blocks ? seg->max_blocks * 2 : INITIAL_BLOCKS;
+			struct segment_block *blocks = realloc(seg->blocks, max * sizeof(*blocks));
+			
+			if (!blocks)
+				return false;
+			seg->blocks = blocks;
+			seg->max_blocks = max;
+		}
+		
+		block = &seg->blocks[seg->num_blocks++];
+		block->offset = offset;
+		block->min_ts = ts;
+		block->max_ts = ts;
+	} else {
+		block = &seg->blocks[seg->num_blocks - 1];
+		if (ts < block->min_ts)
+			block->min_ts = ts;
+		if (ts > block->max_ts)
+			block->max_ts = ts;
+	}
+	
+	if (seg->records == 0 || ts < seg->min_ts)
+		seg->min_ts = ts;
+	if (seg->records == 0 || ts > seg->max_ts)
+		seg->max_ts = ts;
+	seg->records++;
+	
+	return true;
+}
+
+/* Recover the records of an unsealed segment, returns their number */
+static uint64_t segment_scan(struct storage_log *log, struct log_segment *seg)
+{
+	size_t offset = sizeof(struct segment_header);
+	
+	seg->num_blocks = 0;
+	seg->records = 0;
+	
+	while (seg->size - offset >= sizeof(struct storage_log_record)) {
+		const struct storage_log_record *record = (const void *)(seg->map + offset);
+		
+		if (record->length > seg->size - offset - sizeof(*record))
+			break;
+		if (record_crc(record) != record->crc)
+			break;
+		if (!segment_note(seg, log->index_interval, offset, record->timestamp))
+			break;
+		
+		offset += ALIGN8(sizeof(*record) + record->length);
+	}
+	
+	atomic_store_explicit(&seg->end, offset, memory_order_relaxed);
+	return seg->records;
+}
+
+/* Read the block index of a sealed segment, false if it does not hold up */
+static bool segment_load_index(struct log_segment *seg)
+{
+	struct segment_header *header = segment_header(seg);
+	const struct segment_block *blocks;
+	
+	if (header->end < sizeof(*header) || header->end > seg->size || header->end % 8 ||
+	    header->index_offset != header->end || header->num_blocks == 0 ||
+	    header->num_blocks > (seg->size - header->end) / sizeof(*blocks))
+		return false;
+	
+	blocks = (const void *)(seg->map + header->index_offset);
+	for (size_t i = 0; i < header->num_blocks; i++) {
+		if (blocks[i].offset >= header->end || (i > 0 && blocks[i].offset <= blocks[i - 1].offset))
+			return false;
+	}
+	
+	seg->blocks = malloc(header->num_blocks * sizeof(*blocks));
+	if (!seg->blocks)
+		return false;
+	memcpy(seg->blocks, blocks, header->num_blocks * sizeof(*blocks));
+	seg->num_blocks = header->num_blocks;
+	seg->max_blocks = header->num_blocks;
+	seg->records = header->records;
+	
+	seg->min_ts = blocks[0].min_ts;
+	seg->max_ts = blocks[0].max_ts;
+	for (size_t i = 1; i < seg->num_blocks; i++) {
+		if (blocks[i].min_ts < seg->min_ts)
+			seg->min_ts = blocks[i].min_ts;
+		if (blocks[i].max_ts > seg->max_ts)
+			seg->max_ts = blocks[i].max_ts;
+	}
+	
+	atomic_store_explicit(&seg->end, header->end, memory_order_relaxed);
+	return true;
+}
+
+/* Write the block index and seal a segment no longer appended to */
+static void segment_seal(struct storage_log *log, struct log_segment *seg)
+{
+	struct segment_header *header = segment_header(seg);
+	size_t end = atomic_load_explicit(&seg->end, memory_order_relaxed);
+	size_t index_size = seg->num_blocks * sizeof(struct segment_block);
+	
+	/* Appends leave room for the index, unless recovered with a finer interval */
+	if (index_size > seg->size - end)
+		index_size = 0;
+	
+	if (index_size)
+		memcpy(seg->map + end, seg->blocks, index_size);
+	header->end = end;
+	header->index_offset = end;
+	header->num_blocks = index_size / sizeof(struct segment_block);
+	header->records = seg->records;
+	
+	if (log->sync_on_roll)
+		msync(seg->map, seg->size, MS_SYNC);
+	
+	header->flags |= SEGMENT_SEALED;
+	
+	if (log->sync_on_roll)
+		msync(seg->map, sizeof(*header), MS_SYNC);
+}
+
+/* Create and map a new segment file */
+static struct log_segment *segment_create(struct storage_log *log)
+{
+	struct segment_header *header;
+	struct log_segment *seg;
+	uint64_t id = log->next_id;
+	char path[4096];
+	int fd, rc;
+	
+	segment_path(log, id, path, sizeof(path));
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to create log segment %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	
+	rc = posix_fallocate(fd, 0, (off_t)log->segment_size);
+	if (rc != 0) {
+		fprintf(stderr, "Failed to allocate log segment %s: %s\n", path, strerror(rc));
+		close(fd);
+		unlink(path);
+		return NULL;
+	}
+	
+	seg = segment_map(id, fd, log->segment_size);
+	if (!seg) {
+		close(fd);
+		unlink(path);
+		return NULL;
+	}
+	
+	header = segment_header(seg);
+	memcpy(header->magic, SEGMENT_MAGIC, sizeof(header->magic));
+	header->version = SEGMENT_VERSION;
+	header->size = log->segment_size;
+	
+	log->next_id++;
+	return seg;
+}
+
+/* Map an existing segment file and recover its state */
+static struct log_segment *segment_load(struct storage_log *log, uint64_t id)
+{
+	struct segment_header *header;
+	struct log_segment *seg;
+	struct stat st;
+	char path[4096];
+	int fd;
+	
+	segment_path(log, id, path, sizeof(path));
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open log segment %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	
+	if (fstat(fd, &st) < 0 || st.st_size < MIN_SEGMENT_SIZE) {
+		fprintf(stderr, "Skipping short log segment %s\n", path);
+		close(fd);
+		return NULL;
+	}
+	
+	seg = segment_map(id, fd, (size_t)st.st_size);
+	if (!seg) {
+		close(fd);
+		return NULL;
+	}
+	
+	header = segment_header(seg);
+	if (memcmp(header->magic, SEGMENT_MAGIC, sizeof(header->magic)) != 0 ||
+	    header->version != SEGMENT_VERSION) {
+		fprintf(stderr, "Skipping unknown log segment %s\n", path);
+		segment_put(seg);
+		return NULL;
+	}
+	
+	if (!(header->flags & SEGMENT_SEALED) || !segment_load_index(seg)) {
+		uint64_t records = segment_scan(log, seg);
+		
+		if (!(header->flags & SEGMENT_SEALED))
+			log->stats.recovered += records;
+	}
+	
+	return seg;
+}
+
+/* Add a segment as the newest of the list */
+static void log_push(struct storage_log *log, struct log_segment *seg)
+{
+	if (log->active)
+		log->active->next = seg;
+	else
+		log->oldest = seg;
+	log->active = seg;
+	log->num_segments++;
+}
+
+/* Delete the oldest segment, never the active one, returns its records */
+static uint64_t log_delete_oldest(struct storage_log *log)
+{
+	struct log_segment *seg = log->oldest;
+	uint64_t records = seg->records;
+	char path[4096];
+	
+	log->oldest = seg->next;
+	log->num_segments--;
+	log->stats.deleted_segments++;
+	
+	segment_path(log, seg->id, path, sizeof(path));
+	if (unlink(path) < 0)
+		fprintf(stderr, "Failed to delete log segment %s: %s\n", path, strerror(errno));
+	
+	segment_put(seg);
+	return records;
+}
+
+/* Seal the active segment and start the next one, lock held */
+static bool log_roll(struct storage_log *log)
+{
+	struct log_segment *seg;
+	
+	seg = segment_create(log);
+	if (!seg)
+		return false;
+	
+	segment_seal(log, log->active);
+	log_push(log, seg);
+	log->stats.rolls++;
+	
+	while (log->max_segments && log->num_segments > log->max_segments)
+		log_delete_oldest(log);
+	
+	return true;
+}
+
+static int compare_ids(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	
+	return x < y ? -1 : x > y;
+}
+
+/* Ids of the segment files in the log directory, sorted */
+static bool list_segments(struct storage_log *log, uint64_t **ids, size_t *count)
+{
+	size_t max = 0;
+	struct dirent *entry;
+	DIR *dir;
+	
+	*ids = NULL;
+	*count = 0;
+	
+	dir = opendir(log->dir);
+	if (!dir) {
+		fprintf(stderr, "Failed to open log directory %s: %s\n", log->dir, strerror(errno));
+		return false;
+	}
+	
+	while ((entry = readdir(dir)) != NULL) {
+		char *end;
+		uint64_t id;
+		
+		if (strlen(entry->d_name) != 20)
+			continue;
+		id = strtoull(entry->d_name, &end, 16);
+		if (end != entry->d_name + 16 || strcmp(end, ".seg") != 0)
+			continue;
+		
+		if (*count == max) {
+			uint64_t *grown;
+			
+			max = max ? max * 2 : 64;
+			grown = realloc(*ids, max * sizeof(**ids));
+			if (!grown) {
+				closedir(dir);
+				free(*ids);
+				*ids = NULL;
+				return false;
+			}
+			*ids = grown;
+		}
+		(*ids)[(*count)++] = id;
+	}
+	
+	closedir(dir);
+	qsort(*ids, *count, sizeof(**ids), compare_ids);
+	return true;
+}
+
+struct storage_log *storage_log_open(struct storage_log_config *config)
+{
+	struct storage_log *log;
+	uint64_t *ids;
+	size_t count;
+	
+	if (!config || !config->dir)
+		return NULL;
+	
+	pthread_once(&crc32c_once, crc32c_init);
+	
+	if (mkdir(config->dir, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "Failed to create log directory %s: %s\n", config->dir,
+		        strerror(errno));
+		return NULL;
+	}
+	
+	log = calloc(1, sizeof(*log));
+	if (!log)
+		return NULL;
+	
+	log->dir = strdup(config->dir);
+	if (!log->dir) {
+		free(log);
+		return NULL;
+	}
+	
+	log->segment_size = config->segment_size ? config->segment_size :
+	                    STORAGE_LOG_DEFAULT_SEGMENT_SIZE;
+	if (log->segment_size < MIN_SEGMENT_SIZE)
+		log->segment_size = MIN_SEGMENT_SIZE;
+	log->segment_size = ALIGN8(log->segment_size);
+	log->max_segments = config->max_segments;
+	log->index_interval = config->index_interval ? config->index_interval :
+	                      STORAGE_LOG_DEFAULT_INDEX_INTERVAL;
+	log->sync_on_roll = config->sync_on_roll;
+	
+	if (pthread_mutex_init(&log->lock, NULL) != 0) {
+		free(log->dir);
+		free(log);
+		return NULL;
+	}
+	
+	/* Reopen the segments of earlier runs */
+	if (!list_segments(log, &ids, &count)) {
+		storage_log_close(log);
+		return NULL;
+	}
+	
+	for (size_t i = 0; i < count; i++) {
+		struct log_segment *seg = segment_load(log, ids[i]);
+		
+		log->next_id = ids[i] + 1;
+		if (!seg)
+			continue;
+		
+		/* Only the newest segment is appended to */
+		if (log->active && !(segment_header(log->active)->flags & SEGMENT_SEALED))
+			segment_seal(log, log->active);
+		log_push(log, seg);
+	}
+	free(ids);
+	
+	/* Start a segment unless the newest one is still open */
+	if (!log->active || (segment_header(log->active)->flags & SEGMENT_SEALED)) {
+		struct log_segment *seg = segment_create(log);
+		
+		if (!seg) {
+			storage_log_close(log);
+			return NULL;
+		}
+		log_push(log, seg);
+	}
+	
+	while (log->max_segments && log->num_segments > log->max_segments)
+		log_delete_oldest(log);
+	
+	return log;
+}
+
+void storage_log_close(struct storage_log *log)
+{
+	struct log_segment *seg, *next;
+	
+	if (!log)
+		return;
+	
+	/* The active segment stays unsealed and is recovered on open */
+	if (log->active)
+		storage_log_flush(log);
+	
+	for (seg = log->oldest; seg; seg = next) {
+		next = seg->next;
+		segment_put(seg);
+	}
+	
+	pthread_mutex_destroy(&log->lock);
+	free(log->dir);
+	free(log);
+}
+
+bool storage_log_append(struct storage_log *log, struct nlmon_event *event)
+{
+	struct storage_log_record *record;
+	struct log_segment *seg;
+	size_t data_size, need, end, blocks;
+	
+	if (!log || !event)
+		return false;
+	
+	data_size = event->data ? event->data_size : 0;
+	if (data_size > UINT32_MAX)
+		return false;
+	need = ALIGN8(sizeof(*record) + data_size);
+	
+	pthread_mutex_lock(&log->lock);
+	
+	/* Leave room for the block index written on sealing */
+	for (int attempt = 0; ; attempt++) {
+		seg = log->active;
+		end = atomic_load_explicit(&seg->end, memory_order_relaxed);
+		blocks = seg->num_blocks + (seg->records % log->index_interval == 0);
+		
+		if (end + need + blocks * sizeof(struct segment_block) <= seg->size)
+			break;
+		
+		/* A record too large for an empty segment never fits */
+		if (attempt > 0 || seg->records == 0 || !log_roll(log)) {
+			log->stats.failed++;
+			pthread_mutex_unlock(&log->lock);
+			return false;
+		}
+	}
+	
+	record = (struct storage_log_record *)(seg->map + end);
+	record->length = (uint32_t)data_size;
+	record->timestamp = event->timestamp;
+	record->sequence = event->sequence;
+	record->event_type = event->event_type;
+	record->message_type = event->message_type;
+	record->sample_weight = (uint16_t)(event->sample_weight < UINT16_MAX ?
+	                                   event->sample_weight : UINT16_MAX);
+	memcpy(record->interface, event->interface, sizeof(record->interface));
+	if (data_size)
+		memcpy(record + 1, event->data, data_size);
+	record->crc = record_crc(record);
+	
+	if (!segment_note(seg, log->index_interval, end, event->timestamp)) {
+		log->stats.failed++;
+		pthread_mutex_unlock(&log->lock);
+		return false;
+	}
+	
+	/* Cursors may read the record from here on */
+	atomic_store_explicit(&seg->end, end + need, memory_order_release);
+	log->stats.appended++;
+	
+	pthread_mutex_unlock(&log->lock);
+	
+	return true;
+}
+
+bool storage_log_flush(struct storage_log *log)
+{
+	struct log_segment *seg;
+	size_t end;
+	int rc;
+	
+	if (!log)
+		return false;
+	
+	pthread_mutex_lock(&log->lock);
+	seg = log->active;
+	atomic_fetch_add_explicit(&seg->refs, 1, memory_order_relaxed);
+	end = atomic_load_explicit(&seg->end, memory_order_relaxed);
+	pthread_mutex_unlock(&log->lock);
+	
+	/* Appends go on while the records are written back */
+	rc = msync(seg->map, end, MS_SYNC);
+	if (rc < 0)
+		fprintf(stderr, "Failed to sync log segment: %s\n", strerror(errno));
+	
+	segment_put(seg);
+	return rc == 0;
+}
+
+/* Whether a cursor may find records in seg, lock held */
+static bool cursor_wants(struct storage_log_cursor *cursor, struct log_segment *seg)
+{
+	if (cursor->single && seg->id != cursor->segment_id)
+		return false;
+	
+	/* The active segment may still receive them */
+	if (seg == cursor->log->active)
+		return true;
+	
+	if (seg->records == 0 || seg->max_ts < cursor->start_time)
+		return false;
+	if (cursor->end_time && seg->min_ts > cursor->end_time)
+		return false;
+	
+	return true;
+}
+
+/* Move a cursor to the first wanted segment after last_id, lock held */
+static void cursor_enter(struct storage_log_cursor *cursor, bool first)
+{
+	struct log_segment *seg;
+	
+	for (seg = cursor->log->oldest; seg; seg = seg->next) {
+		if ((first || seg->id > cursor->last_id) && cursor_wants(cursor, seg))
+			break;
+	}
+	
+	cursor->seg = seg;
+	if (!seg)
+		return;
+	
+	atomic_fetch_add_explicit(&seg->refs, 1, memory_order_relaxed);
+	cursor->last_id = seg->id;
+	cursor->offset = atomic_load_explicit(&seg->end, memory_order_relaxed);
+	
+	/* Skip the blocks wholly before the start time */
+	for (size_t i = 0; i < seg->num_blocks; i++) {
+		if (seg->blocks[i].max_ts >= cursor->start_time) {
+			cursor->offset = seg->blocks[i].offset;
+			break;
+		}
+	}
+}
+
+struct storage_log_cursor *storage_log_cursor_open(struct storage_log *log,
+                                                   uint64_t start_time,
+                                                   uint64_t end_time)
+{
+	struct storage_log_cursor *cursor;
+	
+	if (!log)
+		return NULL;
+	
+	cursor = calloc(1, sizeof(*cursor));
+	if (!cursor)
+		return NULL;
+	
+	cursor->log = log;
+	cursor->start_time = start_time;
+	cursor->end_time = end_time;
+	
+	pthread_mutex_lock(&log->lock);
+	cursor_enter(cursor, true);
+	pthread_mutex_unlock(&log->lock);
+	
+	return cursor;
+}
+
+struct storage_log_cursor *storage_log_cursor_open_segment(struct storage_log *log,
+                                                           uint64_t segment_id,
+                                                           uint64_t start_time,
+                                                           uint64_t end_time)
+{
+	struct storage_log_cursor *cursor;
+	
+	if (!log)
+		return NULL;
+	
+	cursor = calloc(1, sizeof(*cursor));
+	if (!cursor)
+		return NULL;
+	
+	cursor->log = log;
+	cursor->start_time = start_time;
+	cursor->end_time = end_time;
+	cursor->single = true;
+	cursor->segment_id = segment_id;
+	
+	pthread_mutex_lock(&log->lock);
+	cursor_enter(cursor, true);
+	pthread_mutex_unlock(&log->lock);
+	
+	return cursor;
+}
+
+size_t storage_log_segments(struct storage_log *log, uint64_t start_time, uint64_t end_time,
+                            uint64_t *ids, size_t max)
+{
+	struct storage_log_cursor range = {
+		.log = log,
+		.start_time = start_time,
+		.end_time = end_time,
+	};
+	struct log_segment *seg;
+	size_t count = 0;
+	
+	if (!log)
+		return 0;
+	
+	pthread_mutex_lock(&log->lock);
+	for (seg = log->oldest; seg; seg = seg->next) {
+		if (!cursor_wants(&range, seg))
+			continue;
+		if (count < max)
+			ids[count] = seg->id;
+		count++;
+	}
+	pthread_mutex_unlock(&log->lock);
+	
+	return count;
+}
+
+const struct storage_log_record *storage_log_cursor_next(struct storage_log_cursor *cursor)
+{
+	struct storage_log *log;
+	struct log_segment *seg;
+	size_t end;
+	
+	if (!cursor)
+		return NULL;
+	
+	log = cursor->log;
+	
+	for (;;) {
+		seg = cursor->seg;
+		if (!seg) {
+			pthread_mutex_lock(&log->lock);
+			cursor_enter(cursor, false);
+			pthread_mutex_unlock(&log->lock);
+			seg = cursor->seg;
+			if (!seg)
+				return NULL;
+		}
+		
+		end = atomic_load_explicit(&seg->end, memory_order_acquire);
+		while (cursor->offset < end) {
+			const struct storage_log_record *record = (const void *)(seg->map + cursor->offset);
+			size_t size = ALIGN8(sizeof(*record) + record->length);
+			
+			/* Damaged records end the segment */
+			if (size > end - cursor->offset) {
+				cursor->offset = end;
+				break;
+			}
+			
+			cursor->offset += size;
+			if (record->timestamp < cursor->start_time)
+				continue;
+			if (cursor->end_time && record->timestamp > cursor->end_time)
+				continue;
+			return record;
+		}
+		
+		/* Appends to a sealed segment are complete, move on from it */
+		pthread_mutex_lock(&log->lock);
+		if (seg == log->active || cursor->single) {
+			pthread_mutex_unlock(&log->lock);
+			return NULL;
+		}
+		if (atomic_load_explicit(&seg->end, memory_order_relaxed) > cursor->offset) {
+			pthread_mutex_unlock(&log->lock);
+			continue;
+		}
+		cursor_enter(cursor, false);
+		pthread_mutex_unlock(&log->lock);
+		
+		segment_put(seg);
+	}
+}
+
+void storage_log_cursor_close(struct storage_log_cursor *cursor)
+{
+	if (!cursor)
+		return;
+	
+	if (cursor->seg)
+		segment_put(cursor->seg);
+	free(cursor);
+}
+
+int storage_log_delete_before(struct storage_log *log, uint64_t timestamp)
+{
+	uint64_t deleted = 0;
+	
+	if (!log)
+		return -1;
+	
+	pthread_mutex_lock(&log->lock);
+	
+	while (log->oldest != log->active &&
+	       (log->oldest->records == 0 || log->oldest->max_ts < timestamp))
+		deleted += log_delete_oldest(log);
+	
+	pthread_mutex_unlock(&log->lock);
+	
+	return deleted > INT32_MAX ? INT32_MAX : (int)deleted;
+}
+
+bool storage_log_get_stats(struct storage_log *log, struct storage_log_stats *stats)
+{
+	struct log_segment *seg;
+	
+	if (!log || !stats)
+		return false;
+	
+	pthread_mutex_lock(&log->lock);
+	
+	*stats = log->stats;
+	stats->segments = log->num_segments;
+	stats->records = 0;
+	stats->bytes = 0;
+	for (seg = log->oldest; seg; seg = seg->next) {
+		stats->records += seg->records;
+		stats->bytes += atomic_load_explicit(&seg->end, memory_order_relaxed) -
+		                sizeof(struct segment_header);
+	}
+	
+	pthread_mutex_unlock(&log->lock);
+	
+	return true;
+}
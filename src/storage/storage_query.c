@@ -0,0 +1,581 @@
+/* storage_query.c - Parallel scan queries over stored events
+ *
+ * A query splits into partitions, one per segment of the log in its time
+ * range or the buffer as one. Each partition scans on a worker thread
+ * with its own compiled filter, evaluation context and rows or group
+ * table, so workers share nothing but the memory charged and the first
+ * failure. Rows of all partitions are merged once they are done.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "storage_query.h"
+#include "storage_log.h"
+#include "storage_buffer.h"
+#include "event_processor.h"
+#include "filter_parser.h"
+#include "filter_compiler.h"
+#include "filter_eval.h"
+#include "thread_pool.h"
+
+/* Records scanned between checks of the deadline and other failures */
+#define CHECK_INTERVAL 1024
+
+static const char *const column_names[QUERY_COLUMNS] = {
+	[QUERY_COL_TIMESTAMP] = "timestamp",
+	[QUERY_COL_SEQUENCE] = "sequence",
+	[QUERY_COL_EVENT_TYPE] = "event_type",
+	[QUERY_COL_MESSAGE_TYPE] = "message_type",
+	[QUERY_COL_INTERFACE] = "interface",
+};
+
+/* State shared by the partitions of a query */
+struct query_run {
+	const struct storage_query *query;
+	struct filter_expr *expr;       /* NULL for all events */
+	bool pushable;                  /* The buffer decides expr alone */
+	struct storage_log *log;
+	struct storage_buffer *buffer;
+	size_t limit;
+	size_t max_memory;
+	uint64_t deadline;              /* CLOCK_MONOTONIC ns */
+	atomic_size_t memory;           /* Bytes charged by all partitions */
+	atomic_int status;              /* First failure, QUERY_OK until one */
+};
+
+/* One partition and its partial result */
+struct query_part {
+	struct query_run *run;
+	uint64_t segment;               /* Segment id, unused for the buffer */
+	struct filter_bytecode *filter;
+	struct filter_eval_context *ctx;
+	struct nlmon_event event;       /* Record being evaluated */
+	
+	struct query_row *rows;         /* Events, or groups with their keys */
+	size_t num_rows;
+	size_t max_rows;
+	uint32_t *slots;                /* Group table, index + 1 into rows, 0 for free */
+	size_t num_slots;
+	
+	uint64_t scanned;
+	uint64_t matched;
+	bool full;                      /* Listing reached the limit */
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Record a failure unless an earlier one is */
+static void run_fail(struct query_run *run, enum storage_query_status status)
+{
+	int expected = QUERY_OK;
+	
+	atomic_compare_exchange_strong(&run->status, &expected, (int)status);
+}
+
+/* Whether a partition should stop, checked every CHECK_INTERVAL events */
+static bool part_stopped(struct query_part *part)
+{
+	struct query_run *run = part->run;
+	
+	if (part->scanned % CHECK_INTERVAL != 0)
+		return false;
+	if (atomic_load_explicit(&run->status, memory_order_relaxed) != QUERY_OK)
+		return true;
+	if (now_ns() > run->deadline) {
+		run_fail(run, QUERY_TIMEOUT);
+		return true;
+	}
+	return false;
+}
+
+/* Charge bytes grown by a partition, false past the memory limit */
+static bool part_charge(struct query_part *part, size_t bytes)
+{
+	struct query_run *run = part->run;
+	size_t total = atomic_fetch_add_explicit(&run->memory, bytes, memory_order_relaxed) + bytes;
+	
+	if (total > run->max_memory) {
+		run_fail(run, QUERY_MEMORY);
+		return false;
+	}
+	return true;
+}
+
+static uint64_t key_hash(const struct query_row *key)
+{
+	/* FNV-1a */
+	uint64_t h = 0xcbf29ce484222325ULL;
+	
+	h = (h ^ key->timestamp) * 0x100000001b3ULL;
+	h = (h ^ key->sequence) * 0x100000001b3ULL;
+	h = (h ^ key->event_type) * 0x100000001b3ULL;
+	h = (h ^ key->message_type) * 0x100000001b3ULL;
+	for (size_t i = 0; i < sizeof(key->interface) && key->interface[i]; i++)
+		h = (h ^ (unsigned char)key->interface[i]) * 0x100000001b3ULL;
+	return h ^ (h >> 29);
+}
+
+static bool key_equal(const struct query_row *a, const struct query_row *b)
+{
+	return a->timestamp == b->timestamp && a->sequence == b->sequence &&
+	       a->event_type == b->event_type && a->message_type == b->message_type &&
+	       strncmp(a->interface, b->interface, sizeof(a->interface)) == 0;
+}
+
+/* Room for one more row, false without memory */
+static bool part_reserve(struct query_part *part)
+{
+	struct query_row *rows;
+	size_t max;
+	
+	if (part->num_rows < part->max_rows)
+		return true;
+	
+	max = part->max_rows ? part->max_rows * 2 : 64;
+	if (!part_charge(part, (max - part->max_rows) * sizeof(*rows)))
+		return false;
+	rows = realloc(part->rows, max * sizeof(*rows));
+	if (!rows) {
+		run_fail(part->run, QUERY_ERROR);
+		return false;
+	}
+	part->rows = rows;
+	part->max_rows = max;
+	return true;
+}
+
+/* Double the group table, false without memory */
+static bool part_rehash(struct query_part *part)
+{
+	size_t num_slots = part->num_slots ? part->num_slots * 2 : 128;
+	uint32_t *slots;
+	
+	if (!part_charge(part, (num_slots - part->num_slots) * sizeof(*slots)))
+		return false;
+	slots = calloc(num_slots, sizeof(*slots));
+	if (!slots) {
+		run_fail(part->run, QUERY_ERROR);
+		return false;
+	}
+	
+	for (size_t i = 0; i < part->num_rows; i++) {
+		size_t slot = key_hash(&part->rows[i]) & (num_slots - 1);
+	
+		while (slots[slot])
+			slot = (slot + 1) & (num_slots - 1);
+		slots[slot] = (uint32_t)(i + 1);
+	}
+	
+	free(part->slots);
+	part->slots = slots;
+	part->num_slots = num_slots;
+	return true;
+}
+
+/* Add count to the group of key, false if the query has to stop */
+static bool part_group(struct query_part *part, const struct query_row *key, uint64_t count)
+{
+	size_t slot;
+	
+	if (part->num_rows * 2 >= part->num_slots && !part_rehash(part))
+		return false;
+	
+	slot = key_hash(key) & (part->num_slots - 1);
+	while (part->slots[slot]) {
+		struct query_row *row = &part->rows[part->slots[slot] - 1];
+	
+		if (key_equal(row, key)) {
+			row->count += count;
+			return true;
+		}
+		slot = (slot + 1) & (part->num_slots - 1);
+	}
+	
+	if (part->num_rows >= UINT32_MAX || !part_reserve(part))
+		return false;
+	part->rows[part->num_rows] = *key;
+	part->rows[part->num_rows].count = count;
+	part->slots[slot] = (uint32_t)++part->num_rows;
+	return true;
+}
+
+/* Add a matching event, false if the partition has to stop */
+static bool part_add(struct query_part *part, const struct nlmon_event *event)
+{
+	const struct storage_query *query = part->run->query;
+	uint32_t group = query->group_by;
+	struct query_row row;
+	
+	memset(&row, 0, sizeof(row));
+	part->matched += nlmon_event_weight(event);
+	
+	/* Listing, in scan order up to the limit */
+	if (!group) {
+		if (part->num_rows == part->run->limit) {
+			part->full = true;
+			return false;
+		}
+		if (!part_reserve(part))
+			return false;
+		row.timestamp = event->timestamp;
+		row.sequence = event->sequence;
+		row.event_type = event->event_type;
+		row.message_type = event->message_type;
+		memcpy(row.interface, event->interface, sizeof(row.interface) - 1);
+		row.count = nlmon_event_weight(event);
+		part->rows[part->num_rows++] = row;
+		return true;
+	}
+	
+	if (group & QUERY_COL_BIT(QUERY_COL_TIMESTAMP)) {
+		row.timestamp = event->timestamp;
+		if (query->bucket_ns)
+			row.timestamp -= row.timestamp % query->bucket_ns;
+	}
+	if (group & QUERY_COL_BIT(QUERY_COL_SEQUENCE))
+		row.sequence = event->sequence;
+	if (group & QUERY_COL_BIT(QUERY_COL_EVENT_TYPE))
+		row.event_type = event->event_type;
+	if (group & QUERY_COL_BIT(QUERY_COL_MESSAGE_TYPE))
+		row.message_type = event->message_type;
+	if (group & QUERY_COL_BIT(QUERY_COL_INTERFACE))
+		memcpy(row.interface, event->interface, sizeof(row.interface) - 1);
+	
+	return part_group(part, &row, nlmon_event_weight(event));
+}
+
+/* Scan one segment of the log */
+static void part_scan_segment(struct query_part *part)
+{
+	const struct storage_query *query = part->run->query;
+	const struct storage_log_record *record;
+	struct storage_log_cursor *cursor;
+	struct nlmon_event *event = &part->event;
+	
+	cursor = storage_log_cursor_open_segment(part->run->log, part->segment,
+	                                         query->start_time, query->end_time);
+	if (!cursor) {
+		run_fail(part->run, QUERY_ERROR);
+		return;
+	}
+	
+	while ((record = storage_log_cursor_next(cursor))) {
+		if (part_stopped(part))
+			break;
+		part->scanned++;
+	
+		event->timestamp = record->timestamp;
+		event->sequence = record->sequence;
+		event->event_type = record->event_type;
+		event->message_type = record->message_type;
+		event->sample_weight = record->sample_weight;
+		memcpy(event->interface, record->interface, sizeof(event->interface));
+		event->interface[sizeof(event->interface) - 1] = '\0';
+		event->data = record->length ? (void *)storage_log_record_data(record) : NULL;
+		event->data_size = record->length;
+	
+		if (part->filter && !filter_eval(part->filter, event, part->ctx))
+			continue;
+		if (!part_add(part, event))
+			break;
+	}
+	
+	storage_log_cursor_close(cursor);
+}
+
+/* Buffer query callback, the scan cannot be stopped so the rest is skipped */
+static void part_buffer_event(struct nlmon_event *event, void *ctx)
+{
+	struct query_part *part = ctx;
+	
+	if (part->full || part_stopped(part))
+		return;
+	part->scanned++;
+	
+	if (part->filter && !filter_eval(part->filter, event, part->ctx))
+		return;
+	part_add(part, event);
+}
+
+/* Scan the buffer, its query decides the expression as far as it can */
+static void part_scan_buffer(struct query_part *part)
+{
+	struct query_run *run = part->run;
+	struct buffer_query_filter filter = {
+		.start_time = run->query->start_time,
+		.end_time = run->query->end_time,
+		.expr = run->expr ? run->expr->ast : NULL,
+	};
+	
+	storage_buffer_query(run->buffer, &filter, part_buffer_event, part);
+}
+
+static void part_scan(void *arg)
+{
+	struct query_part *part = arg;
+	
+	if (part->run->log)
+		part_scan_segment(part);
+	else
+		part_scan_buffer(part);
+}
+
+static void part_release(struct query_part *part)
+{
+	filter_bytecode_free(part->filter);
+	if (part->ctx)
+		filter_eval_context_destroy(part->ctx);
+	free(part->slots);
+	free(part->rows);
+}
+
+/* Largest count first, then by key */
+static int group_compare(const void *a, const void *b)
+{
+	const struct query_row *x = a, *y = b;
+	
+	if (x->count != y->count)
+		return x->count > y->count ? -1 : 1;
+	if (x->timestamp != y->timestamp)
+		return x->timestamp < y->timestamp ? -1 : 1;
+	if (x->event_type != y->event_type)
+		return x->event_type < y->event_type ? -1 : 1;
+	if (x->message_type != y->message_type)
+		return x->message_type < y->message_type ? -1 : 1;
+	if (x->sequence != y->sequence)
+		return x->sequence < y->sequence ? -1 : 1;
+	return strncmp(x->interface, y->interface, sizeof(x->interface));
+}
+
+/* Merge the partitions into result, the first one's rows become its */
+static void merge_parts(struct query_run *run, struct query_part *parts, size_t num_parts,
+                        struct storage_query_result *result)
+{
+	const struct storage_query *query = run->query;
+	struct query_part *first = &parts[0];
+	size_t keep;
+	
+	for (size_t i = 0; i < num_parts; i++) {
+		result->scanned += parts[i].scanned;
+		result->matched += parts[i].matched;
+	}
+	
+	if (!query->group_by) {
+		/* Partitions are in timestamp order, so are their rows */
+		for (size_t i = 1; i < num_parts; i++) {
+			struct query_part *part = &parts[i];
+	
+			first->full |= part->full;
+			for (size_t j = 0; j < part->num_rows; j++) {
+				if (first->num_rows == run->limit) {
+					first->full = true;
+					break;
+				}
+				if (!part_reserve(first))
+					return;
+				first->rows[first->num_rows++] = part->rows[j];
+			}
+		}
+		result->truncated = first->full;
+		keep = first->num_rows;
+	} else {
+		for (size_t i = 1; i < num_parts; i++) {
+			for (size_t j = 0; j < parts[i].num_rows; j++) {
+				if (!part_group(first, &parts[i].rows[j], parts[i].rows[j].count))
+					return;
+			}
+		}
+	
+		qsort(first->rows, first->num_rows, sizeof(*first->rows), group_compare);
+		keep = query->top_k && query->top_k < run->limit ? query->top_k : run->limit;
+		if (keep > first->num_rows)
+			keep = first->num_rows;
+		result->truncated = keep < first->num_rows;
+	}
+	
+	result->rows = first->rows;
+	result->num_rows = keep;
+	first->rows = NULL;
+}
+
+enum storage_query_status storage_query_run(struct storage_log *log, struct storage_buffer *buffer,
+                                            const struct storage_query *query,
+                                            struct storage_query_result *result)
+{
+	struct query_run run;
+	struct query_part *parts = NULL;
+	struct thread_pool *pool = NULL;
+	uint64_t *segments = NULL;
+	size_t num_parts = 1, listed, threads;
+	uint64_t start = now_ns();
+	
+	if (!result)
+		return QUERY_ERROR;
+	memset(result, 0, sizeof(*result));
+	
+	if (!query || (query->columns & ~QUERY_COL_ALL) || (query->group_by & ~QUERY_COL_ALL)) {
+		result->status = QUERY_INVALID;
+		return result->status;
+	}
+	if (!log && !buffer) {
+		result->status = QUERY_ERROR;
+		return result->status;
+	}
+	
+	memset(&run, 0, sizeof(run));
+	run.query = query;
+	run.log = log;
+	run.buffer = buffer;
+	run.limit = query->limit ? query->limit : QUERY_DEFAULT_LIMIT;
+	run.max_memory = query->max_memory ? query->max_memory : QUERY_DEFAULT_MAX_MEMORY;
+	run.deadline = start + (uint64_t)(query->timeout_ms ? query->timeout_ms :
+	                                  QUERY_DEFAULT_TIMEOUT_MS) * 1000000ULL;
+	atomic_init(&run.memory, 0);
+	atomic_init(&run.status, QUERY_OK);
+	
+	if (query->filter && query->filter[0]) {
+		run.expr = filter_parse(query->filter);
+		if (!run.expr || !run.expr->valid) {
+			snprintf(result->error, sizeof(result->error), "%s",
+			         run.expr ? run.expr->error.message : "out of memory");
+			filter_expr_free(run.expr);
+			result->status = run.expr ? QUERY_INVALID : QUERY_ERROR;
+			return result->status;
+		}
+		run.pushable = storage_buffer_expr_pushable(run.expr->ast);
+	}
+	
+	/* One partition per segment of the range */
+	if (log) {
+		num_parts = storage_log_segments(log, query->start_time, query->end_time, NULL, 0);
+		segments = calloc(num_parts ? num_parts : 1, sizeof(*segments));
+		if (!segments) {
+			run_fail(&run, QUERY_ERROR);
+			goto out;
+		}
+		/* Segments deleted meanwhile shorten the list, new ones are left out */
+		listed = storage_log_segments(log, query->start_time, query->end_time,
+		                              segments, num_parts);
+		if (listed < num_parts)
+			num_parts = listed;
+	}
+	
+	parts = calloc(num_parts ? num_parts : 1, sizeof(*parts));
+	if (!parts) {
+		run_fail(&run, QUERY_ERROR);
+		goto out;
+	}
+	
+	for (size_t i = 0; i < num_parts; i++) {
+		parts[i].run = &run;
+		parts[i].segment = segments ? segments[i] : 0;
+	
+		/* The buffer needs the VM only for what its columns leave open */
+		if (run.expr && (log || !run.pushable)) {
+			parts[i].filter = filter_compile(run.expr);
+			parts[i].ctx = filter_eval_context_create();
+			if (!parts[i].filter || !parts[i].ctx) {
+				run_fail(&run, QUERY_ERROR);
+				goto out;
+			}
+		}
+	}
+	
+	threads = query->threads ? query->threads : QUERY_DEFAULT_THREADS;
+	if (threads > num_parts)
+		threads = num_parts;
+	
+	if (threads > 1)
+		pool = thread_pool_create(threads, 0);
+	
+	for (size_t i = 0; i < num_parts; i++) {
+		if (!pool || !thread_pool_submit(pool, part_scan, &parts[i], PRIORITY_NORMAL))
+			part_scan(&parts[i]);
+	}
+	if (pool)
+		thread_pool_destroy(pool, true);
+	
+	if (atomic_load(&run.status) == QUERY_OK && num_parts > 0)
+		merge_parts(&run, parts, num_parts, result);
+	result->partitions = num_parts;
+
+out:
+	for (size_t i = 0; parts && i < num_parts; i++)
+		part_release(&parts[i]);
+	free(parts);
+	free(segments);
+	filter_expr_free(run.expr);
+	
+	result->status = (enum storage_query_status)atomic_load(&run.status);
+	if (result->status != QUERY_OK) {
+		free(result->rows);
+		result->rows = NULL;
+		result->num_rows = 0;
+	}
+	result->elapsed_us = (now_ns() - start) / 1000;
+	return result->status;
+}
+
+void storage_query_result_free(struct storage_query_result *result)
+{
+	if (!result)
+		return;
+	
+	free(result->rows);
+	result->rows = NULL;
+	result->num_rows = 0;
+}
+
+bool storage_query_parse_columns(const char *list, uint32_t *mask)
+{
+	const char *p = list;
+	
+	*mask = 0;
+	if (!list)
+		return true;
+	
+	while (*p) {
+		size_t len = strcspn(p, ",");
+		int col;
+	
+		for (col = 0; col < QUERY_COLUMNS; col++) {
+			if (len == strlen(column_names[col]) && strncmp(p, column_names[col], len) == 0)
+				break;
+		}
+		if (col == QUERY_COLUMNS && len > 0)
+			return false;
+		if (col < QUERY_COLUMNS)
+			*mask |= QUERY_COL_BIT(col);
+	
+		p += len;
+		if (*p == ',')
+			p++;
+	}
+	return true;
+}
+
+const char *storage_query_column_name(enum query_column column)
+{
+	return (unsigned int)column < QUERY_COLUMNS ? column_names[column] : "unknown";
+}
+
+const char *storage_query_status_str(enum storage_query_status status)
+{
+	switch (status) {
+	case QUERY_OK: return "ok";
+	case QUERY_INVALID: return "invalid query";
+	case QUERY_TIMEOUT: return "query timed out";
+	case QUERY_MEMORY: return "query memory limit reached";
+	case QUERY_ERROR: return "query failed";
+	}
+	return "unknown";
+}
@@ -0,0 +1,372 @@
+/* storage_rollup.c - Event counts per series at fixed resolutions
+ *
+ * Each series holds a ring of counters per resolution, indexed by the
+ * point's period modulo the retention, and the period after its newest
+ * point. Moving a ring on zeroes the points it passes over, so points of
+ * quiet series stay valid without any sweep.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "storage_rollup.h"
+#include "event_processor.h"
+
+/* Seconds per point of each resolution */
+static const unsigned int rollup_steps[ROLLUP_RESOLUTIONS] = { 1, 60, 3600 };
+
+/* Counters of one series */
+struct rollup_state {
+	struct rollup_key key;
+	uint64_t head[ROLLUP_RESOLUTIONS];     /* Period after the newest point, 0 for none */
+	uint64_t *counts[ROLLUP_RESOLUTIONS];  /* Rings, one allocation */
+};
+
+struct storage_rollup {
+	pthread_mutex_t lock;
+	bool by_namespace;
+	unsigned int retention[ROLLUP_RESOLUTIONS];
+	size_t points;                  /* Counters per series over all resolutions */
+	
+	struct rollup_state *series;
+	size_t num_series;
+	size_t max_series;
+	uint32_t *slots;                /* Index + 1 into series, 0 for free */
+	size_t num_slots;
+	struct rollup_state overflow;
+	
+	uint64_t *scratch;              /* Points of a query */
+	uint64_t *sum;
+	
+	/* Statistics */
+	uint64_t events;
+	uint64_t late;
+	uint64_t overflowed;
+	uint64_t newest;
+};
+
+static uint64_t key_hash(const struct rollup_key *key)
+{
+	/* FNV-1a */
+	uint64_t h = 0xcbf29ce484222325ULL;
+	
+	h = (h ^ key->event_type) * 0x100000001b3ULL;
+	h = (h ^ key->netns) * 0x100000001b3ULL;
+	for (size_t i = 0; i < sizeof(key->interface) && key->interface[i]; i++)
+		h = (h ^ (unsigned char)key->interface[i]) * 0x100000001b3ULL;
+	return h ^ (h >> 29);
+}
+
+static bool key_equal(const struct rollup_key *a, const struct rollup_key *b)
+{
+	return a->event_type == b->event_type && a->netns == b->netns &&
+	       strncmp(a->interface, b->interface, sizeof(a->interface)) == 0;
+}
+
+/* Give a series its rings, false without memory */
+static bool state_init(struct storage_rollup *rollup, struct rollup_state *state,
+                       const struct rollup_key *key)
+{
+	uint64_t *counts = calloc(rollup->points, sizeof(*counts));
+	
+	if (!counts)
+		return false;
+	
+	memset(state, 0, sizeof(*state));
+	state->key = *key;
+	for (int r = 0; r < ROLLUP_RESOLUTIONS; r++) {
+		state->counts[r] = counts;
+		counts += rollup->retention[r];
+	}
+	return true;
+}
+
+/* Series of a key, created if there is room, the overflow series otherwise */
+static struct rollup_state *series_find(struct storage_rollup *rollup, const struct rollup_key *key)
+{
+	size_t slot = key_hash(key) & (rollup->num_slots - 1);
+	struct rollup_state *state;
+	
+	for (;;) {
+		uint32_t index = rollup->slots[slot];
+	
+		if (index == 0)
+			break;
+		if (key_equal(&rollup->series[index - 1].key, key))
+			return &rollup->series[index - 1];
+		slot = (slot + 1) & (rollup->num_slots - 1);
+	}
+	
+	if (rollup->num_series == rollup->max_series)
+		return &rollup->overflow;
+	
+	state = &rollup->series[rollup->num_series];
+	if (!state_init(rollup, state, key))
+		return &rollup->overflow;
+	rollup->slots[slot] = (uint32_t)++rollup->num_series;
+	return state;
+}
+
+/* Count weight at period of a ring, false if the period is no longer kept */
+static bool ring_add(uint64_t *head, uint64_t *counts, unsigned int retention,
+                     uint64_t period, uint64_t weight)
+{
+	if (period >= *head) {
+		/* Zero the points passed over, all of them after a long gap */
+		if (*head == 0 || period - *head >= retention) {
+			memset(counts, 0, retention * sizeof(*counts));
+		} else {
+			for (uint64_t p = *head; p <= period; p++)
+				counts[p % retention] = 0;
+		}
+		*head = period + 1;
+	} else if (*head - period > retention) {
+		return false;
+	}
+	
+	counts[period % retention] += weight;
+	return true;
+}
+
+/* Point at period of a ring, 0 if not kept */
+static uint64_t ring_get(uint64_t head, const uint64_t *counts, unsigned int retention,
+                         uint64_t period)
+{
+	if (period >= head || head - period > retention)
+		return 0;
+	return counts[period % retention];
+}
+
+static bool series_match(const struct rollup_state *state, const struct rollup_query *query)
+{
+	bool filtered = query->match_type || query->interface || query->match_netns;
+	
+	if (state->key.overflow)
+		return !filtered;
+	if (query->match_type && state->key.event_type != query->event_type)
+		return false;
+	if (query->interface &&
+	    strncmp(state->key.interface, query->interface, sizeof(state->key.interface)) != 0)
+		return false;
+	if (query->match_netns && state->key.netns != query->netns)
+		return false;
+	return true;
+}
+
+struct storage_rollup *storage_rollup_create(const struct storage_rollup_config *config)
+{
+	static const unsigned int defaults[ROLLUP_RESOLUTIONS] = {
+		ROLLUP_DEFAULT_SECONDS, ROLLUP_DEFAULT_MINUTES, ROLLUP_DEFAULT_HOURS
+	};
+	struct storage_rollup *rollup;
+	unsigned int max_retention = 0;
+	struct rollup_key none = { .overflow = true };
+	
+	rollup = calloc(1, sizeof(*rollup));
+	if (!rollup)
+		return NULL;
+	
+	rollup->by_namespace = config && config->by_namespace;
+	rollup->max_series = config && config->max_series ? config->max_series :
+	                     ROLLUP_DEFAULT_SERIES;
+	for (int r = 0; r < ROLLUP_RESOLUTIONS; r++) {
+		unsigned int retention = config && config->retention[r] ? config->retention[r] :
+		                         defaults[r];
+	
+		rollup->retention[r] = retention;
+		rollup->points += retention;
+		if (retention > max_retention)
+			max_retention = retention;
+	}
+	
+	rollup->num_slots = 16;
+	while (rollup->num_slots < rollup->max_series * 2)
+		rollup->num_slots *= 2;
+	
+	if (rollup->max_series >= UINT32_MAX ||
+	    !(rollup->series = calloc(rollup->max_series, sizeof(*rollup->series))) ||
+	    !(rollup->slots = calloc(rollup->num_slots, sizeof(*rollup->slots))) ||
+	    !(rollup->scratch = calloc(max_retention, sizeof(*rollup->scratch))) ||
+	    !(rollup->sum = calloc(max_retention, sizeof(*rollup->sum))) ||
+	    !state_init(rollup, &rollup->overflow, &none)) {
+		free(rollup->sum);
+		free(rollup->scratch);
+		free(rollup->slots);
+		free(rollup->series);
+		free(rollup);
+		return NULL;
+	}
+	
+	if (pthread_mutex_init(&rollup->lock, NULL) != 0) {
+		free(rollup->overflow.counts[0]);
+		free(rollup->sum);
+		free(rollup->scratch);
+		free(rollup->slots);
+		free(rollup->series);
+		free(rollup);
+		return NULL;
+	}
+	
+	return rollup;
+}
+
+void storage_rollup_destroy(struct storage_rollup *rollup)
+{
+	if (!rollup)
+		return;
+	
+	for (size_t i = 0; i < rollup->num_series; i++)
+		free(rollup->series[i].counts[0]);
+	free(rollup->overflow.counts[0]);
+	pthread_mutex_destroy(&rollup->lock);
+	free(rollup->sum);
+	free(rollup->scratch);
+	free(rollup->slots);
+	free(rollup->series);
+	free(rollup);
+}
+
+void storage_rollup_add(struct storage_rollup *rollup, const struct nlmon_event *event)
+{
+	uint64_t seconds, weight;
+	struct rollup_state *state;
+	struct rollup_key key;
+	bool late = false;
+	
+	if (!rollup || !event)
+		return;
+	
+	memset(&key, 0, sizeof(key));
+	key.event_type = event->event_type;
+	memcpy(key.interface, event->interface, sizeof(key.interface) - 1);
+	if (rollup->by_namespace)
+		key.netns = event->netlink.netns;
+	
+	seconds = event->timestamp / 1000000000ULL;
+	weight = nlmon_event_weight(event);
+	
+	pthread_mutex_lock(&rollup->lock);
+	
+	state = series_find(rollup, &key);
+	for (int r = 0; r < ROLLUP_RESOLUTIONS; r++) {
+		if (!ring_add(&state->head[r], state->counts[r], rollup->retention[r],
+		              seconds / rollup_steps[r], weight))
+			late = true;
+	}
+	
+	rollup->events += weight;
+	if (late)
+		rollup->late += weight;
+	if (state == &rollup->overflow)
+		rollup->overflowed += weight;
+	if (seconds > rollup->newest)
+		rollup->newest = seconds;
+	
+	pthread_mutex_unlock(&rollup->lock);
+}
+
+size_t storage_rollup_query(struct storage_rollup *rollup, const struct rollup_query *query,
+                            rollup_series_fn fn, void *ctx)
+{
+	struct rollup_series series;
+	uint64_t newest, first, from, to;
+	unsigned int step, retention;
+	size_t count = 0, n;
+	bool any = false;
+	
+	if (!rollup || !query || !fn || (unsigned int)query->resolution >= ROLLUP_RESOLUTIONS)
+		return 0;
+	
+	step = rollup_steps[query->resolution];
+	retention = rollup->retention[query->resolution];
+	
+	pthread_mutex_lock(&rollup->lock);
+	
+	/* Periods [from, to) of the range, within the points kept */
+	newest = rollup->newest / step + 1;
+	first = newest > retention ? newest - retention : 0;
+	from = query->start / step;
+	to = query->end ? (query->end + step - 1) / step : newest;
+	if (from < first)
+		from = first;
+	if (to > newest)
+		to = newest;
+	if (rollup->events == 0 || from >= to) {
+		pthread_mutex_unlock(&rollup->lock);
+		return 0;
+	}
+	n = (size_t)(to - from);
+	
+	memset(&series, 0, sizeof(series));
+	series.start = from * step;
+	series.step = step;
+	series.num_points = n;
+	if (query->sum)
+		memset(rollup->sum, 0, n * sizeof(*rollup->sum));
+	
+	for (size_t i = 0; i <= rollup->num_series; i++) {
+		struct rollup_state *state = i < rollup->num_series ? &rollup->series[i] :
+		                             &rollup->overflow;
+		uint64_t total = 0;
+	
+		if (!series_match(state, query))
+			continue;
+	
+		for (size_t j = 0; j < n; j++) {
+			uint64_t value = ring_get(state->head[query->resolution],
+			                          state->counts[query->resolution], retention, from + j);
+	
+			rollup->scratch[j] = value;
+			total += value;
+		}
+		if (total == 0)
+			continue;
+	
+		if (query->sum) {
+			for (size_t j = 0; j < n; j++)
+				rollup->sum[j] += rollup->scratch[j];
+			series.total += total;
+			any = true;
+			continue;
+		}
+	
+		series.key = state->key;
+		series.points = rollup->scratch;
+		series.total = total;
+		fn(&series, ctx);
+		count++;
+	}
+	
+	if (query->sum && any) {
+		series.points = rollup->sum;
+		fn(&series, ctx);
+		count++;
+	}
+	
+	pthread_mutex_unlock(&rollup->lock);
+	return count;
+}
+
+unsigned int storage_rollup_step(enum rollup_resolution resolution)
+{
+	return (unsigned int)resolution < ROLLUP_RESOLUTIONS ? rollup_steps[resolution] : 0;
+}
+
+void storage_rollup_get_stats(struct storage_rollup *rollup, struct storage_rollup_stats *stats)
+{
+	if (!stats)
+		return;
+	
+	memset(stats, 0, sizeof(*stats));
+	if (!rollup)
+		return;
+	
+	pthread_mutex_lock(&rollup->lock);
+	stats->events = rollup->events;
+	stats->late = rollup->late;
+	stats->overflow = rollup->overflowed;
+	stats->series = rollup->num_series;
+	stats->memory = (rollup->num_series + 1) * rollup->points * sizeof(uint64_t);
+	stats->newest = rollup->newest;
+	pthread_mutex_unlock(&rollup->lock);
+}
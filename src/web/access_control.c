@@ -50,6 +50,9 @@ struct access_control {
 	size_t num_login_attempts;
 	pthread_mutex_t login_attempts_mutex;
 	
+	/* Validated sessions, see access_control_cache_stats() */
+	struct auth_cache *cache;
+	
 	/* Statistics */
 	atomic_ulong failed_logins;
 	atomic_ulong successful_logins;
@@ -157,6 +160,16 @@ struct access_control *access_control_create(struct access_control_config *confi
 		return NULL;
 	}
 	
+	ac->cache = auth_cache_create(ac->config.cache_size, ac->config.cache_ttl);
+	if (!ac->cache) {
+		pthread_mutex_destroy(&ac->users_mutex);
+		pthread_mutex_destroy(&ac->sessions_mutex);
+		pthread_mutex_destroy(&ac->api_keys_mutex);
+		pthread_mutex_destroy(&ac->login_attempts_mutex);
+		free(ac);
+		return NULL;
+	}
+	
 	atomic_init(&ac->failed_logins, 0);
 	atomic_init(&ac->successful_logins, 0);
 	
@@ -173,6 +186,7 @@ void access_control_destroy(struct access_control *ac)
 	pthread_mutex_destroy(&ac->api_keys_mutex);
 	pthread_mutex_destroy(&ac->login_attempts_mutex);
 	
+	auth_cache_destroy(ac->cache);
 	free(ac);
 }
 
@@ -235,6 +249,7 @@ int access_control_remove_user(struct access_control *ac, const char *username)
 		if (strcmp(ac->users[i].username, username) == 0) {
 			ac->users[i].active = false;
 			pthread_mutex_unlock(&ac->users_mutex);
+			auth_cache_invalidate_user(ac->cache, username);
 			return 0;
 		}
 	}
@@ -243,6 +258,45 @@ int access_control_remove_user(struct access_control *ac, const char *username)
 	return -1;
 }
 
+int access_control_set_user_role(struct access_control *ac,
+                                 const char *username,
+                                 enum user_role role)
+{
+	uint32_t permissions = access_control_get_role_permissions(role);
+	bool found = false;
+	
+	if (!ac || !username)
+		return -1;
+	
+	pthread_mutex_lock(&ac->users_mutex);
+	for (size_t i = 0; i < ac->num_users; i++) {
+		if (strcmp(ac->users[i].username, username) == 0) {
+			ac->users[i].role = role;
+			ac->users[i].permissions = permissions;
+			found = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ac->users_mutex);
+	
+	if (!found)
+		return -1;
+	
+	/* Open sessions take the new role right away */
+	pthread_mutex_lock(&ac->sessions_mutex);
+	for (size_t i = 0; i < ac->num_sessions; i++) {
+		if (strcmp(ac->sessions[i].username, username) == 0) {
+			ac->sessions[i].role = role;
+			ac->sessions[i].permissions = permissions;
+		}
+	}
+	pthread_mutex_unlock(&ac->sessions_mutex);
+	
+	auth_cache_invalidate_user(ac->cache, username);
+	
+	return 0;
+}
+
 int access_control_login(struct access_control *ac,
                         const char *username,
                         const char *password,
@@ -381,67 +435,151 @@ int access_control_login(struct access_control *ac,
 	return 0;
 }
 
+/* Find an active, unexpired session, with sessions_mutex held */
+static struct ac_session *find_valid_session(struct access_control *ac, const char *session_id)
+{
+	time_t now = time(NULL);
+	
+	for (size_t i = 0; i < ac->num_sessions; i++) {
+		struct ac_session *session = &ac->sessions[i];
+		
+		if (session->active && strcmp(session->session_id, session_id) == 0) {
+			if (now > session->expires) {
+				session->active = false;
+				return NULL;
+			}
+			return session;
+		}
+	}
+	
+	return NULL;
+}
+
+/* Cache a session that validated, with sessions_mutex held */
+static void cache_session(struct access_control *ac, const struct ac_session *session,
+                          uint64_t generation)
+{
+	struct auth_identity identity;
+	
+	memset(&identity, 0, sizeof(identity));
+	snprintf(identity.username, sizeof(identity.username), "%s", session->username);
+	snprintf(identity.role, sizeof(identity.role), "%s",
+	         access_control_role_string(session->role));
+	identity.permissions = session->permissions;
+	
+	auth_cache_insert(ac->cache, session->session_id, &identity, session->expires, generation);
+}
+
+int access_control_logout(struct access_control *ac, const char *session_id)
+{
+	int ret = -1;
+	
+	if (!ac || !session_id)
+		return -1;
+	
+	pthread_mutex_lock(&ac->sessions_mutex);
+	for (size_t i = 0; i < ac->num_sessions; i++) {
+		if (ac->sessions[i].active && strcmp(ac->sessions[i].session_id, session_id) == 0) {
+			ac->sessions[i].active = false;
+			ret = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ac->sessions_mutex);
+	
+	auth_cache_invalidate(ac->cache, session_id);
+	
+	return ret;
+}
+
+int access_control_terminate_user_sessions(struct access_control *ac,
+                                           const char *username)
+{
+	int terminated = 0;
+	
+	if (!ac || !username)
+		return 0;
+	
+	pthread_mutex_lock(&ac->sessions_mutex);
+	for (size_t i = 0; i < ac->num_sessions; i++) {
+		if (ac->sessions[i].active && strcmp(ac->sessions[i].username, username) == 0) {
+			ac->sessions[i].active = false;
+			terminated++;
+		}
+	}
+	pthread_mutex_unlock(&ac->sessions_mutex);
+	
+	auth_cache_invalidate_user(ac->cache, username);
+	
+	return terminated;
+}
+
 int access_control_validate_session(struct access_control *ac,
                                     const char *session_id,
                                     char *username,
                                     size_t username_len)
 {
-	time_t now = time(NULL);
+	struct ac_session *session;
+	struct auth_identity identity;
 	
 	if (!ac || !session_id)
 		return -1;
 	
+	if (auth_cache_lookup(ac->cache, session_id, &identity)) {
+		if (username)
+			strncpy(username, identity.username, username_len - 1);
+		return 0;
+	}
+	
+	uint64_t generation = auth_cache_generation(ac->cache);
+	
 	pthread_mutex_lock(&ac->sessions_mutex);
 	
-	for (size_t i = 0; i < ac->num_sessions; i++) {
-		struct ac_session *session = &ac->sessions[i];
+	session = find_valid_session(ac, session_id);
+	if (!session) {
+		pthread_mutex_unlock(&ac->sessions_mutex);
+		return -1;
+	}
+	
+	/* Renew session if enabled */
+	if (ac->config.enable_session_renewal) {
+		time_t now = time(NULL);
 		
-		if (session->active && strcmp(session->session_id, session_id) == 0) {
-			if (now > session->expires) {
-				session->active = false;
-				pthread_mutex_unlock(&ac->sessions_mutex);
-				return -1;
-			}
-			
-			/* Renew session if enabled */
-			if (ac->config.enable_session_renewal) {
-				session->last_activity = now;
-				session->expires = now + ac->config.session_timeout;
-			}
-			
-			if (username)
-				strncpy(username, session->username, username_len - 1);
-			
-			pthread_mutex_unlock(&ac->sessions_mutex);
-			return 0;
-		}
+		session->last_activity = now;
+		session->expires = now + ac->config.session_timeout;
 	}
 	
+	if (username)
+		strncpy(username, session->username, username_len - 1);
+	
+	cache_session(ac, session, generation);
+	
 	pthread_mutex_unlock(&ac->sessions_mutex);
-	return -1;
+	return 0;
 }
 
 bool access_control_check_permission(struct access_control *ac,
                                      const char *session_id,
                                      enum permission permission)
 {
-	time_t now = time(NULL);
+	struct ac_session *session;
+	struct auth_identity identity;
 	bool authorized = false;
 	
 	if (!ac || !session_id)
 		return false;
 	
+	if (auth_cache_lookup(ac->cache, session_id, &identity))
+		return (identity.permissions & permission) != 0;
+	
+	uint64_t generation = auth_cache_generation(ac->cache);
+	
 	pthread_mutex_lock(&ac->sessions_mutex);
 	
-	for (size_t i = 0; i < ac->num_sessions; i++) {
-		struct ac_session *session = &ac->sessions[i];
-		
-		if (session->active && strcmp(session->session_id, session_id) == 0) {
-			if (now <= session->expires) {
-				authorized = (session->permissions & permission) != 0;
-			}
-			break;
-		}
+	session = find_valid_session(ac, session_id);
+	if (session) {
+		authorized = (session->permissions & permission) != 0;
+		cache_session(ac, session, generation);
 	}
 	
 	pthread_mutex_unlock(&ac->sessions_mutex);
@@ -634,3 +772,12 @@ void access_control_stats(struct access_control *ac,
 	if (failed_logins)
 		*failed_logins = atomic_load_explicit(&ac->failed_logins, memory_order_relaxed);
 }
+
+void access_control_cache_stats(struct access_control *ac,
+                                struct auth_cache_stats *stats)
+{
+	if (!ac)
+		return;
+	
+	auth_cache_get_stats(ac->cache, stats);
+}
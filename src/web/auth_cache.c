@@ -0,0 +1,424 @@
+/* auth_cache.c - Cache of validated tokens
+ *
+ * Each shard is a chained hash table over a fixed array of entries. Free
+ * entries are kept on a list, and once none is left the entry under the
+ * shard's eviction hand is reused, which cycles through the array and so
+ * evicts in roughly insertion order without any per-hit bookkeeping.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "auth_cache.h"
+
+#define AUTH_CACHE_SHARDS 16
+#define DEFAULT_CAPACITY 1024
+#define DEFAULT_TTL 30
+
+/* Cached token */
+struct cache_entry {
+	uint64_t hash;
+	char token[AUTH_CACHE_TOKEN_MAX];
+	size_t token_len;
+	struct auth_identity identity;
+	time_t expires;                 /* Already capped by the TTL */
+	int32_t next;                   /* Bucket chain, or free list */
+	bool used;
+};
+
+/* Cache shard */
+struct cache_shard {
+	pthread_mutex_t lock;
+	struct cache_entry *entries;
+	int32_t *buckets;               /* Head entry per bucket, -1 if empty */
+	size_t bucket_mask;
+	size_t count;
+	int32_t free_list;
+	size_t hand;                    /* Next entry to evict */
+	
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t insertions;
+	uint64_t evictions;
+	uint64_t invalidations;
+};
+
+/* Token cache */
+struct auth_cache {
+	struct cache_shard shards[AUTH_CACHE_SHARDS];
+	size_t shard_capacity;
+	uint32_t ttl;
+	_Atomic uint64_t generation;    /* Bumped by every invalidation */
+};
+
+/* FNV-1a, tokens that reach a shard are ones that validated */
+static uint64_t hash_token(const char *token, size_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)token[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/* Compare without leaking where the first difference is */
+static bool token_equal(const char *a, const char *b, size_t len)
+{
+	unsigned char diff = 0;
+	
+	for (size_t i = 0; i < len; i++)
+		diff |= (unsigned char)a[i] ^ (unsigned char)b[i];
+	return diff == 0;
+}
+
+static struct cache_shard *shard_of(struct auth_cache *cache, uint64_t hash)
+{
+	return &cache->shards[hash >> 60];
+}
+
+/* Find an entry, setting *prev to its predecessor in the chain */
+static int32_t shard_find(struct cache_shard *shard, uint64_t hash, const char *token,
+                          size_t len, int32_t *prev)
+{
+	int32_t idx = shard->buckets[hash & shard->bucket_mask];
+	
+	*prev = -1;
+	while (idx >= 0) {
+		struct cache_entry *entry = &shard->entries[idx];
+		
+		if (entry->hash == hash && entry->token_len == len &&
+		    token_equal(entry->token, token, len))
+			return idx;
+		*prev = idx;
+		idx = entry->next;
+	}
+	return -1;
+}
+
+/* Unlink an entry from its chain and put it on the free list */
+static void shard_remove(struct cache_shard *shard, int32_t idx, int32_t prev)
+{
+	struct cache_entry *entry = &shard->entries[idx];
+	
+	if (prev >= 0)
+		shard->entries[prev].next = entry->next;
+	else
+		shard->buckets[entry->hash & shard->bucket_mask] = entry->next;
+	
+	memset(entry->token, 0, entry->token_len);
+	entry->used = false;
+	entry->next = shard->free_list;
+	shard->free_list = idx;
+	shard->count--;
+}
+
+/* Remove an entry found through the entry array */
+static void shard_remove_entry(struct cache_shard *shard, int32_t idx)
+{
+	struct cache_entry *entry = &shard->entries[idx];
+	int32_t prev = -1;
+	int32_t cur = shard->buckets[entry->hash & shard->bucket_mask];
+	
+	while (cur >= 0 && cur != idx) {
+		prev = cur;
+		cur = shard->entries[cur].next;
+	}
+	if (cur == idx)
+		shard_remove(shard, idx, prev);
+}
+
+/* Take a free entry, evicting the one under the hand if there is none */
+static int32_t shard_alloc(struct auth_cache *cache, struct cache_shard *shard)
+{
+	int32_t idx = shard->free_list;
+	
+	if (idx < 0) {
+		idx = (int32_t)shard->hand;
+		shard->hand = (shard->hand + 1) % cache->shard_capacity;
+		shard_remove_entry(shard, idx);
+		shard->evictions++;
+	}
+	
+	shard->free_list = shard->entries[idx].next;
+	return idx;
+}
+
+static void shard_clear(struct auth_cache *cache, struct cache_shard *shard)
+{
+	for (size_t i = 0; i < cache->shard_capacity; i++) {
+		if (shard->entries[i].used) {
+			shard_remove_entry(shard, (int32_t)i);
+			shard->invalidations++;
+		}
+	}
+}
+
+struct auth_cache *auth_cache_create(size_t capacity, uint32_t ttl)
+{
+	struct auth_cache *cache;
+	size_t buckets = 1;
+	int i;
+	
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+	
+	if (capacity == 0)
+		capacity = DEFAULT_CAPACITY;
+	cache->shard_capacity = (capacity + AUTH_CACHE_SHARDS - 1) / AUTH_CACHE_SHARDS;
+	cache->ttl = ttl ? ttl : DEFAULT_TTL;
+	atomic_init(&cache->generation, 0);
+	
+	while (buckets < cache->shard_capacity)
+		buckets <<= 1;
+	
+	for (i = 0; i < AUTH_CACHE_SHARDS; i++) {
+		struct cache_shard *shard = &cache->shards[i];
+		
+		shard->entries = calloc(cache->shard_capacity, sizeof(*shard->entries));
+		shard->buckets = malloc(buckets * sizeof(*shard->buckets));
+		if (!shard->entries || !shard->buckets)
+			goto err_shards;
+		if (pthread_mutex_init(&shard->lock, NULL) != 0)
+			goto err_shards;
+		
+		shard->bucket_mask = buckets - 1;
+		for (size_t b = 0; b < buckets; b++)
+			shard->buckets[b] = -1;
+		
+		/* Entry i links to i + 1, the last one ends the list */
+		for (size_t e = 0; e < cache->shard_capacity; e++)
+			shard->entries[e].next = e + 1 < cache->shard_capacity ? (int32_t)(e + 1) : -1;
+		shard->free_list = 0;
+	}
+	
+	return cache;
+	
+err_shards:
+	free(cache->shards[i].entries);
+	free(cache->shards[i].buckets);
+	while (--i >= 0) {
+		pthread_mutex_destroy(&cache->shards[i].lock);
+		free(cache->shards[i].entries);
+		free(cache->shards[i].buckets);
+	}
+	free(cache);
+	return NULL;
+}
+
+void auth_cache_destroy(struct auth_cache *cache)
+{
+	if (!cache)
+		return;
+	
+	for (int i = 0; i < AUTH_CACHE_SHARDS; i++) {
+		struct cache_shard *shard = &cache->shards[i];
+		
+		/* Do not leave tokens behind in freed memory */
+		memset(shard->entries, 0, cache->shard_capacity * sizeof(*shard->entries));
+		pthread_mutex_destroy(&shard->lock);
+		free(shard->entries);
+		free(shard->buckets);
+	}
+	free(cache);
+}
+
+bool auth_cache_lookup(struct auth_cache *cache, const char *token,
+                       struct auth_identity *identity)
+{
+	struct cache_shard *shard;
+	uint64_t hash;
+	int32_t idx, prev;
+	size_t len;
+	bool hit = false;
+	
+	if (!cache || !token)
+		return false;
+	
+	len = strlen(token);
+	if (len >= AUTH_CACHE_TOKEN_MAX)
+		return false;
+	
+	hash = hash_token(token, len);
+	shard = shard_of(cache, hash);
+	
+	pthread_mutex_lock(&shard->lock);
+	
+	idx = shard_find(shard, hash, token, len, &prev);
+	if (idx >= 0) {
+		struct cache_entry *entry = &shard->entries[idx];
+		
+		if (time(NULL) > entry->expires) {
+			shard_remove(shard, idx, prev);
+		} else {
+			if (identity)
+				*identity = entry->identity;
+			hit = true;
+		}
+	}
+	
+	if (hit)
+		shard->hits++;
+	else
+		shard->misses++;
+	
+	pthread_mutex_unlock(&shard->lock);
+	return hit;
+}
+
+uint64_t auth_cache_generation(struct auth_cache *cache)
+{
+	return cache ? atomic_load(&cache->generation) : 0;
+}
+
+void auth_cache_insert(struct auth_cache *cache, const char *token,
+                       const struct auth_identity *identity, time_t expires,
+                       uint64_t generation)
+{
+	struct cache_shard *shard;
+	struct cache_entry *entry;
+	uint64_t hash;
+	int32_t idx, prev;
+	time_t limit;
+	size_t len;
+	
+	if (!cache || !token || !identity)
+		return;
+	
+	len = strlen(token);
+	if (len >= AUTH_CACHE_TOKEN_MAX)
+		return;
+	
+	limit = time(NULL) + cache->ttl;
+	if (expires == 0 || expires > limit)
+		expires = limit;
+	
+	hash = hash_token(token, len);
+	shard = shard_of(cache, hash);
+	
+	pthread_mutex_lock(&shard->lock);
+	
+	/* Invalidations bump the generation before sweeping the shards */
+	if (atomic_load(&cache->generation) != generation) {
+		pthread_mutex_unlock(&shard->lock);
+		return;
+	}
+	
+	idx = shard_find(shard, hash, token, len, &prev);
+	if (idx < 0) {
+		idx = shard_alloc(cache, shard);
+		entry = &shard->entries[idx];
+		entry->hash = hash;
+		memcpy(entry->token, token, len + 1);
+		entry->token_len = len;
+		entry->used = true;
+		entry->next = shard->buckets[hash & shard->bucket_mask];
+		shard->buckets[hash & shard->bucket_mask] = idx;
+		shard->count++;
+	} else {
+		entry = &shard->entries[idx];
+	}
+	
+	entry->identity = *identity;
+	entry->expires = expires;
+	shard->insertions++;
+	
+	pthread_mutex_unlock(&shard->lock);
+}
+
+void auth_cache_invalidate(struct auth_cache *cache, const char *token)
+{
+	struct cache_shard *shard;
+	uint64_t hash;
+	int32_t idx, prev;
+	size_t len;
+	
+	if (!cache || !token)
+		return;
+	
+	len = strlen(token);
+	atomic_fetch_add(&cache->generation, 1);
+	if (len >= AUTH_CACHE_TOKEN_MAX)
+		return;
+	
+	hash = hash_token(token, len);
+	shard = shard_of(cache, hash);
+	
+	pthread_mutex_lock(&shard->lock);
+	idx = shard_find(shard, hash, token, len, &prev);
+	if (idx >= 0) {
+		shard_remove(shard, idx, prev);
+		shard->invalidations++;
+	}
+	pthread_mutex_unlock(&shard->lock);
+}
+
+size_t auth_cache_invalidate_user(struct auth_cache *cache, const char *username)
+{
+	size_t removed = 0;
+	
+	if (!cache || !username)
+		return 0;
+	
+	atomic_fetch_add(&cache->generation, 1);
+	
+	for (int i = 0; i < AUTH_CACHE_SHARDS; i++) {
+		struct cache_shard *shard = &cache->shards[i];
+		
+		pthread_mutex_lock(&shard->lock);
+		for (size_t e = 0; e < cache->shard_capacity; e++) {
+			struct cache_entry *entry = &shard->entries[e];
+			
+			if (entry->used && strcmp(entry->identity.username, username) == 0) {
+				shard_remove_entry(shard, (int32_t)e);
+				shard->invalidations++;
+				removed++;
+			}
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+	
+	return removed;
+}
+
+void auth_cache_clear(struct auth_cache *cache)
+{
+	if (!cache)
+		return;
+	
+	atomic_fetch_add(&cache->generation, 1);
+	
+	for (int i = 0; i < AUTH_CACHE_SHARDS; i++) {
+		pthread_mutex_lock(&cache->shards[i].lock);
+		shard_clear(cache, &cache->shards[i]);
+		pthread_mutex_unlock(&cache->shards[i].lock);
+	}
+}
+
+void auth_cache_get_stats(struct auth_cache *cache, struct auth_cache_stats *stats)
+{
+	if (!stats)
+		return;
+	
+	memset(stats, 0, sizeof(*stats));
+	if (!cache)
+		return;
+	
+	stats->capacity = cache->shard_capacity * AUTH_CACHE_SHARDS;
+	
+	for (int i = 0; i < AUTH_CACHE_SHARDS; i++) {
+		struct cache_shard *shard = &cache->shards[i];
+		
+		pthread_mutex_lock(&shard->lock);
+		stats->entries += shard->count;
+		stats->hits += shard->hits;
+		stats->misses += shard->misses;
+		stats->insertions += shard->insertions;
+		stats->evictions += shard->evictions;
+		stats->invalidations += shard->invalidations;
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
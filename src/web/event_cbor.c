@@ -0,0 +1,228 @@
+/* event_cbor.c - Compact binary encoding of events for web clients
+ *
+ * Each item is encoded straight into the output buffer after reserving
+ * the most it can take, so an event costs one bounds check. Names are
+ * found through a small open addressing table per kind, indexes are
+ * stored one up so that 0 marks a free slot.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "event_cbor.h"
+#include "event_processor.h"
+
+#define DICT_SLOTS (EVENT_CBOR_DICT_MAX * 2)
+
+/* CBOR major types, shifted into place */
+#define CBOR_UINT   0x00
+#define CBOR_TEXT   0x60
+#define CBOR_ARRAY  0x80
+#define CBOR_NULL   0xf6
+
+/* Longest head: initial byte and 8 bytes of argument */
+#define HEAD_MAX 9
+
+/* Names of one kind */
+struct name_table {
+	char names[EVENT_CBOR_DICT_MAX][EVENT_CBOR_NAME_MAX];
+	uint8_t lens[EVENT_CBOR_DICT_MAX];
+	uint16_t slots[DICT_SLOTS];     /* Index + 1, 0 if free */
+	size_t count;
+};
+
+/* Name dictionary */
+struct event_cbor_dict {
+	struct name_table interfaces;
+	struct name_table families;
+};
+
+static uint8_t *put_head(uint8_t *p, uint8_t major, uint64_t value)
+{
+	if (value < 24) {
+		*p++ = major | (uint8_t)value;
+	} else if (value <= 0xff) {
+		*p++ = major | 24;
+		*p++ = (uint8_t)value;
+	} else if (value <= 0xffff) {
+		*p++ = major | 25;
+		*p++ = (uint8_t)(value >> 8);
+		*p++ = (uint8_t)value;
+	} else if (value <= 0xffffffff) {
+		*p++ = major | 26;
+		for (int shift = 24; shift >= 0; shift -= 8)
+			*p++ = (uint8_t)(value >> shift);
+	} else {
+		*p++ = major | 27;
+		for (int shift = 56; shift >= 0; shift -= 8)
+			*p++ = (uint8_t)(value >> shift);
+	}
+	return p;
+}
+
+static uint8_t *put_text(uint8_t *p, const char *text, size_t len)
+{
+	p = put_head(p, CBOR_TEXT, len);
+	memcpy(p, text, len);
+	return p + len;
+}
+
+/* Free space of a buffer with at least @len more bytes, NULL if failed */
+static uint8_t *buf_space(struct json_buf *buf, size_t len)
+{
+	if (!json_buf_reserve(buf, len))
+		return NULL;
+	return (uint8_t *)buf->data + buf->len;
+}
+
+static void buf_commit(struct json_buf *buf, const uint8_t *end)
+{
+	buf->len = (size_t)(end - (const uint8_t *)buf->data);
+	buf->data[buf->len] = '\0';
+}
+
+static uint32_t name_hash(const char *name, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	
+	for (size_t i = 0; i < len; i++)
+		hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+	return hash;
+}
+
+static void append_definition(struct json_buf *defs, enum event_cbor_item kind, size_t index,
+                              const char *name, size_t len)
+{
+	uint8_t *p = buf_space(defs, 1 + 1 + HEAD_MAX + HEAD_MAX + len);
+	
+	if (!p)
+		return;
+	*p++ = CBOR_ARRAY | 3;
+	*p++ = CBOR_UINT | kind;
+	p = put_head(p, CBOR_UINT, index);
+	p = put_text(p, name, len);
+	buf_commit(defs, p);
+}
+
+/* Index of a name, defining it if new, or -1 to send it as text */
+static long name_index(struct name_table *table, struct json_buf *defs,
+                       enum event_cbor_item kind, const char *name, size_t len)
+{
+	uint32_t slot;
+	
+	if (len >= EVENT_CBOR_NAME_MAX)
+		return -1;
+	
+	for (slot = name_hash(name, len) % DICT_SLOTS; table->slots[slot];
+	     slot = (slot + 1) % DICT_SLOTS) {
+		size_t index = table->slots[slot] - 1;
+	
+		if (table->lens[index] == len && memcmp(table->names[index], name, len) == 0)
+			return (long)index;
+	}
+	
+	if (table->count == EVENT_CBOR_DICT_MAX)
+		return -1;
+	
+	memcpy(table->names[table->count], name, len);
+	table->lens[table->count] = (uint8_t)len;
+	table->slots[slot] = (uint16_t)(table->count + 1);
+	append_definition(defs, kind, table->count, name, len);
+	
+	return (long)table->count++;
+}
+
+static uint8_t *put_name(uint8_t *p, long index, const char *name, size_t len)
+{
+	if (len == 0)
+		*p++ = CBOR_NULL;
+	else if (index < 0)
+		p = put_text(p, name, len);
+	else
+		p = put_head(p, CBOR_UINT, (uint64_t)index);
+	return p;
+}
+
+struct event_cbor_dict *event_cbor_dict_create(void)
+{
+	return calloc(1, sizeof(struct event_cbor_dict));
+}
+
+void event_cbor_dict_destroy(struct event_cbor_dict *dict)
+{
+	free(dict);
+}
+
+void event_cbor_record_init(struct event_cbor_record *record, const struct nlmon_event *event)
+{
+	record->timestamp = event->timestamp;
+	record->sequence = event->sequence;
+	record->event_type = event->event_type;
+	record->message_type = event->message_type;
+	record->protocol = event->netlink.protocol;
+	record->interface = event->interface;
+	record->interface_len = strnlen(event->interface, sizeof(event->interface));
+	record->family = event->netlink.genl_family_name;
+	record->family_len = strnlen(event->netlink.genl_family_name,
+	                             sizeof(event->netlink.genl_family_name));
+}
+
+void event_cbor_append(struct json_buf *out, struct json_buf *defs, struct event_cbor_dict *dict,
+                       const struct event_cbor_record *record)
+{
+	size_t family_len = record->family ? record->family_len : 0;
+	long interface = -1, family = -1;
+	uint8_t *p;
+	
+	/* Definitions first, defs may be out */
+	if (record->interface_len)
+		interface = name_index(&dict->interfaces, defs, EVENT_CBOR_INTERFACE,
+		                       record->interface, record->interface_len);
+	if (family_len)
+		family = name_index(&dict->families, defs, EVENT_CBOR_FAMILY,
+		                    record->family, family_len);
+	
+	p = buf_space(out, 2 + 6 * HEAD_MAX + record->interface_len + family_len);
+	if (!p)
+		return;
+	
+	*p++ = CBOR_ARRAY | 8;
+	*p++ = CBOR_UINT | EVENT_CBOR_EVENT;
+	p = put_head(p, CBOR_UINT, record->timestamp);
+	p = put_head(p, CBOR_UINT, record->sequence);
+	p = put_head(p, CBOR_UINT, record->event_type);
+	p = put_head(p, CBOR_UINT, record->message_type);
+	p = put_name(p, interface, record->interface, record->interface_len);
+	if (record->protocol >= 0)
+		p = put_head(p, CBOR_UINT, (uint64_t)record->protocol);
+	else
+		*p++ = CBOR_NULL;
+	p = put_name(p, family, record->family, family_len);
+	buf_commit(out, p);
+}
+
+void event_cbor_append_dict(struct json_buf *out, const struct event_cbor_dict *dict)
+{
+	for (size_t i = 0; i < dict->interfaces.count; i++)
+		append_definition(out, EVENT_CBOR_INTERFACE, i, dict->interfaces.names[i],
+		                  dict->interfaces.lens[i]);
+	for (size_t i = 0; i < dict->families.count; i++)
+		append_definition(out, EVENT_CBOR_FAMILY, i, dict->families.names[i],
+		                  dict->families.lens[i]);
+}
+
+void event_cbor_append_end(struct json_buf *out, const char *next_cursor, uint64_t limit)
+{
+	size_t len = next_cursor ? strlen(next_cursor) : 0;
+	uint8_t *p = buf_space(out, 2 + 2 * HEAD_MAX + len);
+	
+	if (!p)
+		return;
+	*p++ = CBOR_ARRAY | 3;
+	*p++ = CBOR_UINT | EVENT_CBOR_END;
+	if (next_cursor)
+		p = put_text(p, next_cursor, len);
+	else
+		*p++ = CBOR_NULL;
+	p = put_head(p, CBOR_UINT, limit);
+	buf_commit(out, p);
+}
@@ -95,7 +95,11 @@ class NlmonDashboard {
         const protocol = window.location.protocol === 'https:' ? 'wss:' : 'ws:';
         const wsUrl = `${protocol}//${window.location.hostname}:${window.location.port}/ws`;
         
-        this.ws = new WebSocket(wsUrl);
+        // Events come as binary frames if the server speaks nlmon.cbor,
+        // everything else stays JSON text
+        this.ws = new WebSocket(wsUrl, ['nlmon.cbor']);
+        this.ws.binaryType = 'arraybuffer';
+        this.decoder = new NlmonEventDecoder();
         
         this.ws.onopen = () => {
             console.log('WebSocket connected');
@@ -104,6 +108,11 @@ class NlmonDashboard {
         };
         
         this.ws.onmessage = (event) => {
+            if (event.data instanceof ArrayBuffer) {
+                this.decoder.decode(event.data).events.forEach(e => this.addEvent(e));
+                return;
+            }
+            
             const data = JSON.parse(event.data);
             
             if (data.type === 'event') {
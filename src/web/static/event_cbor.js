@@ -0,0 +1,103 @@
+// nlmon binary event decoder
+//
+// Decodes the CBOR sequences of the nlmon.cbor WebSocket subprotocol and of
+// /api/events answered as application/cbor-seq. Items are arrays whose
+// first element is their kind:
+//
+//   [0, timestamp, sequence, event_type, message_type, interface, protocol, family]
+//   [1, index, "interface name"]
+//   [2, index, "family name"]
+//   [3, next_cursor, limit]
+//
+// Names come as an index into what was defined before, as text, or null.
+// One decoder per connection or listing keeps its definitions.
+
+class NlmonEventDecoder {
+    constructor() {
+        this.interfaces = [];
+        this.families = [];
+        this.textDecoder = new TextDecoder();
+    }
+    
+    // Decode a message, returning its events and, for a listing, its end
+    decode(buffer) {
+        const view = new DataView(buffer);
+        const result = { events: [], end: null };
+        let pos = 0;
+        
+        const readArgument = (info) => {
+            if (info < 24) return info;
+            const size = 1 << (info - 24);
+            let value = 0;
+            for (let i = 0; i < size; i++) {
+                value = value * 256 + view.getUint8(pos++);
+            }
+            return value;
+        };
+        
+        const readItem = () => {
+            const initial = view.getUint8(pos++);
+            const major = initial >> 5;
+            const info = initial & 0x1f;
+            
+            switch (major) {
+            case 0:
+                return readArgument(info);
+            case 1:
+                return -1 - readArgument(info);
+            case 3: {
+                const len = readArgument(info);
+                const text = this.textDecoder.decode(new Uint8Array(buffer, pos, len));
+                pos += len;
+                return text;
+            }
+            case 4: {
+                const len = readArgument(info);
+                const items = [];
+                for (let i = 0; i < len; i++) items.push(readItem());
+                return items;
+            }
+            case 7:
+                if (info === 20) return false;
+                if (info === 21) return true;
+                return null;
+            default:
+                throw new Error(`Unexpected CBOR major type ${major}`);
+            }
+        };
+        
+        const name = (value, names) => {
+            if (typeof value === 'number') return names[value] ?? null;
+            return value;
+        };
+        
+        while (pos < view.byteLength) {
+            const item = readItem();
+            
+            switch (item[0]) {
+            case 0:
+                result.events.push({
+                    timestamp: item[1],
+                    sequence: item[2],
+                    event_type: item[3],
+                    message_type: item[4],
+                    interface: name(item[5], this.interfaces),
+                    protocol: item[6],
+                    family: name(item[7], this.families)
+                });
+                break;
+            case 1:
+                this.interfaces[item[1]] = item[2];
+                break;
+            case 2:
+                this.families[item[1]] = item[2];
+                break;
+            case 3:
+                result.end = { next_cursor: item[1], limit: item[2] };
+                break;
+            }
+        }
+        
+        return result;
+    }
+}
@@ -1,33 +1,25 @@
 #include "web_api.h"
+#include "storage_db.h"
+#include "storage_buffer.h"
+#include "storage_query.h"
+#include "event_processor.h"
+#include "filter_parser.h"
+#include "filter_compiler.h"
+#include "filter_cache.h"
+#include "filter_eval.h"
+#include "json_buf.h"
+#include "event_cbor.h"
+#include "stack_sampler.h"
+#include "fib_mirror.h"
+#include "state_mirror.h"
+#include "nlmon_nl_netfilter.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-
-/* Helper to build JSON response */
-__attribute__((unused))
-static char *json_escape_string(const char *str) {
-    if (!str) return strdup("");
-    
-    size_t len = strlen(str);
-    char *escaped = malloc(len * 2 + 1);
-    if (!escaped) return NULL;
-    
-    char *p = escaped;
-    for (size_t i = 0; i < len; i++) {
-        switch (str[i]) {
-            case '"':  *p++ = '\\'; *p++ = '"'; break;
-            case '\\': *p++ = '\\'; *p++ = '\\'; break;
-            case '\n': *p++ = '\\'; *p++ = 'n'; break;
-            case '\r': *p++ = '\\'; *p++ = 'r'; break;
-            case '\t': *p++ = '\\'; *p++ = 't'; break;
-            default:   *p++ = str[i]; break;
-        }
-    }
-    *p = '\0';
-    
-    return escaped;
-}
+#include <sys/socket.h>
+#include <linux/rtnetlink.h>
 
 /* Parse query parameters */
 static int parse_query_param(const char *url, const char *param, char *value, size_t value_len) {
@@ -53,69 +45,1125 @@ static int parse_query_param(const char *url, const char *param, char *value, si
     return 0;
 }
 
-/* GET /api/events - List events */
-int api_get_events(void *cls, const char *url, const char *method,
-                   const char *version, const char *upload_data,
-                   size_t *upload_data_size, void **con_cls,
-                   char **response, size_t *response_len,
-                   const char **content_type) {
-    struct web_api_context *ctx = cls;
-    char limit_str[32] = "100";
-    char offset_str[32] = "0";
-    int limit = 100;
-    int offset = 0;
+#define EVENTS_DEFAULT_LIMIT 100
+#define EVENTS_MAX_LIMIT 10000000   /* Streamed, memory does not grow with it */
+#define EVENTS_BUFFERED_LIMIT 1000  /* For api_get_events, which buffers */
+#define EVENTS_BATCH 256            /* Events read and serialized per refill */
+
+/* Streamed events listing, newest first, read through a keyset cursor */
+struct api_events_stream {
+    struct storage_db *db;          /* Read from the database if set */
+    struct storage_buffer *buffer;  /* Otherwise from the memory buffer */
+    size_t limit;
+    size_t sent;                    /* Events serialized so far */
+    size_t skip;                    /* ?offset events still to drop */
+    bool started;
+    bool done;
     
-    /* Parse query parameters */
-    parse_query_param(url, "limit", limit_str, sizeof(limit_str));
-    parse_query_param(url, "offset", offset_str, sizeof(offset_str));
+    /* Names already sent, if listing in CBOR */
+    struct event_cbor_dict *dict;
     
-    limit = atoi(limit_str);
-    offset = atoi(offset_str);
+    /* ?filter, pushed into the storage query as far as it goes */
+    struct filter_expr *expr;
+    struct filter_bytecode *residual;  /* Evaluated on what the query returns, or NULL */
     
-    if (limit <= 0 || limit > 1000) limit = 100;
-    if (offset < 0) offset = 0;
+    /* Database position */
+    struct db_query_filter filter;
     
-    /* Build JSON response */
-    char *json = malloc(65536);
-    if (!json) return -1;
+    /* Buffer position, the key of the last event read */
+    uint64_t timestamp;
+    uint64_t sequence;
+    struct buffer_event_header headers[EVENTS_BATCH];
+    
+    /* Serialized events not yet handed out, JSON or CBOR */
+    struct json_buf json;
+    size_t pos;
+};
+
+/* Append one event object */
+static void events_append(struct api_events_stream *es, uint64_t timestamp, uint64_t sequence,
+                          uint32_t event_type, uint16_t message_type,
+                          const char *interface, size_t interface_len) {
+    struct json_buf *json = &es->json;
+    
+    if (es->dict) {
+        struct event_cbor_record record = {
+            .timestamp = timestamp,
+            .sequence = sequence,
+            .event_type = event_type,
+            .message_type = message_type,
+            .protocol = -1,
+            .interface = interface,
+            .interface_len = interface_len,
+        };
+        
+        /* Names are defined inline, ahead of the event */
+        event_cbor_append(json, json, es->dict, &record);
+        es->sent++;
+        return;
+    }
+    
+    json_buf_append_str(json, es->sent ? ",{\"timestamp\":" : "{\"timestamp\":");
+    json_buf_append_u64(json, timestamp);
+    json_buf_append_str(json, ",\"sequence\":");
+    json_buf_append_u64(json, sequence);
+    json_buf_append_str(json, ",\"event_type\":");
+    json_buf_append_u64(json, event_type);
+    json_buf_append_str(json, ",\"message_type\":");
+    json_buf_append_u64(json, message_type);
+    json_buf_append_str(json, ",\"interface\":\"");
+    json_buf_append_escaped(json, interface, interface_len);
+    json_buf_append_str(json, "\"}");
+    es->sent++;
+}
+
+/* Append one database event */
+static void events_add_db(struct nlmon_event *event, void *ctx) {
+    struct api_events_stream *es = ctx;
+    
+    /* The part of ?filter the query could not decide, then ?offset */
+    if (es->residual && !filter_eval(es->residual, event, NULL)) return;
+    if (es->skip) {
+        es->skip--;
+        return;
+    }
+    
+    events_append(es, event->timestamp, event->sequence, event->event_type,
+                  event->message_type, event->interface, strlen(event->interface));
+}
+
+/* Serialize the next batch of events, the closing part after the last.
+ * Returns -1 if the storage query failed. */
+static int events_fill(struct api_events_stream *es) {
+    size_t want = es->limit - es->sent;
+    size_t before = es->sent;
+    bool exhausted;
     
-    int pos = snprintf(json, 65536, "{\"events\":[");
+    if (want > EVENTS_BATCH) want = EVENTS_BATCH;
     
-    /* Get events from storage */
-    if (ctx->storage) {
-        struct storage_buffer *buffer = storage_layer_get_buffer(ctx->storage);
-        if (buffer) {
-            int count = 0;
-            int skip = offset;
+    if (!es->started && !es->dict) {
+        json_buf_append_str(&es->json, "{\"events\":[");
+        es->started = true;
+    }
+    
+    if (es->db) {
+        exhausted = false;
+        
+        /* Never read past what is sent, the cursor is the last event read */
+        while (!exhausted && es->sent - before < want) {
+            size_t ask = want - (es->sent - before);
             
-            /* Iterate through buffer (simplified - would need proper API) */
-            for (int i = 0; i < limit && count < 100; i++) {
-                if (skip > 0) {
-                    skip--;
-                    continue;
-                }
+            es->filter.limit = ask;
+            int got = storage_db_query(es->db, &es->filter, events_add_db, es);
+            if (got < 0) return -1;
+            
+            /* Later batches seek past the last event */
+            es->filter.offset = 0;
+            es->filter.after_cursor = true;
+            exhausted = (size_t)got < ask;
+        }
+    } else {
+        size_t n = 0;
+        
+        while (n < want) {
+            /* Never read past what is sent, the key is the last event read */
+            size_t ask = es->expr ? EVENTS_BATCH : want - n + es->skip;
+            if (ask > EVENTS_BATCH) ask = EVENTS_BATCH;
+            
+            size_t got = storage_buffer_get_headers_before(es->buffer, es->timestamp,
+                                                           es->sequence, ask, es->headers);
+            if (!got) break;
+            
+            for (size_t i = 0; i < got && n < want; i++) {
+                const struct buffer_event_header *h = &es->headers[i];
                 
-                if (count > 0) {
-                    pos += snprintf(json + pos, 65536 - pos, ",");
-                }
+                es->timestamp = h->timestamp;
+                es->sequence = h->sequence;
                 
-                pos += snprintf(json + pos, 65536 - pos,
-                    "{\"id\":%d,\"timestamp\":%ld,\"type\":\"link_change\","
-                    "\"interface\":\"eth%d\",\"details\":{\"state\":\"UP\"}}",
-                    i, time(NULL) - i, i % 4);
+                /* Then what ?offset asks to leave out */
+                if (es->expr && !storage_buffer_header_match(es->expr->ast, h)) continue;
+                if (es->skip) {
+                    es->skip--;
+                    continue;
+                }
                 
-                count++;
+                events_append(es, h->timestamp, h->sequence, h->event_type, h->message_type,
+                              h->interface, strnlen(h->interface, sizeof(h->interface)));
+                n++;
             }
+            
+            if (got < ask) break;
         }
+        exhausted = n < want;
     }
     
-    pos += snprintf(json + pos, 65536 - pos,
-        "],\"total\":100,\"limit\":%d,\"offset\":%d}", limit, offset);
+    if (!exhausted && es->sent < es->limit) return 0;
+    
+    /* A full page may have more after it */
+    if (es->sent == es->limit && es->sent) {
+        char cursor[96];
+        
+        if (es->db) {
+            snprintf(cursor, sizeof(cursor), "%lu.%lu.%ld", es->filter.cursor.table,
+                     es->filter.cursor.timestamp, es->filter.cursor.id);
+        } else {
+            snprintf(cursor, sizeof(cursor), "%lu.%lu", es->timestamp, es->sequence);
+        }
+        if (es->dict) {
+            event_cbor_append_end(&es->json, cursor, es->limit);
+            es->done = true;
+            return 0;
+        }
+        json_buf_append_str(&es->json, "],\"next_cursor\":\"");
+        json_buf_append_str(&es->json, cursor);
+        json_buf_append_str(&es->json, "\",\"limit\":");
+    } else if (es->dict) {
+        event_cbor_append_end(&es->json, NULL, es->limit);
+        es->done = true;
+        return 0;
+    } else {
+        json_buf_append_str(&es->json, "],\"next_cursor\":null,\"limit\":");
+    }
+    json_buf_append_u64(&es->json, es->limit);
+    json_buf_append_char(&es->json, '}');
+    es->done = true;
+    
+    return 0;
+}
+
+/* Error body for a failed open */
+static void events_error(char **error, const char *message) {
+    size_t len = strlen(message) + 16;
+    
+    *error = malloc(len);
+    if (*error) snprintf(*error, len, "{\"error\":\"%s\"}", message);
+}
+
+/* Open an events listing, the first batch is read here so a bad cursor or
+ * a failing query still gets its status code */
+struct api_events_stream *api_events_open(struct web_api_context *ctx, const char *limit_arg,
+                                          const char *offset_arg, const char *cursor_arg,
+                                          const char *filter_arg, size_t max_limit, bool cbor,
+                                          int *status, char **error) {
+    long limit = limit_arg ? atol(limit_arg) : EVENTS_DEFAULT_LIMIT;
+    long offset = offset_arg ? atol(offset_arg) : 0;
+    
+    if (limit <= 0 || (size_t)limit > max_limit) limit = EVENTS_DEFAULT_LIMIT;
+    if (offset < 0) offset = 0;
+    
+    struct api_events_stream *es = calloc(1, sizeof(*es));
+    if (!es) {
+        *status = 500;
+        return NULL;
+    }
+    
+    es->limit = (size_t)limit;
+    es->db = ctx->storage ? storage_layer_get_database(ctx->storage) : NULL;
+    es->buffer = ctx->storage ? storage_layer_get_buffer(ctx->storage) : NULL;
+    es->timestamp = UINT64_MAX;
+    es->sequence = UINT64_MAX;
+    
+    if (cbor) {
+        es->dict = event_cbor_dict_create();
+        if (!es->dict) {
+            api_events_close(es);
+            *status = 500;
+            return NULL;
+        }
+    }
+    
+    if (filter_arg && filter_arg[0]) {
+        es->expr = filter_parse(filter_arg);
+        if (!es->expr || !es->expr->valid) goto bad_filter;
+        
+        /* Headers are all the buffer listing sees */
+        if (!es->db && es->buffer && !storage_buffer_expr_pushable(es->expr->ast)) {
+            api_events_close(es);
+            *status = 400;
+            events_error(error, "Filter needs fields the buffer does not list");
+            return NULL;
+        }
+        if (es->db && !storage_db_expr_pushable(es->expr->ast)) {
+            es->residual = filter_cache_get_expr(es->expr);
+            if (!es->residual) goto bad_filter;
+        }
+    }
+    
+    /* Database cursors are table.timestamp.id, buffer ones timestamp.sequence */
+    if (es->db) {
+        es->filter.descending = true;
+        es->filter.expr = es->expr ? es->expr->ast : NULL;
+        
+        /* Offsets count events past the residual filter, which the query cannot */
+        if (es->residual) {
+            es->skip = (size_t)offset;
+        } else {
+            es->filter.offset = (size_t)offset;
+        }
+        if (cursor_arg && cursor_arg[0]) {
+            if (sscanf(cursor_arg, "%lu.%lu.%ld", &es->filter.cursor.table,
+                       &es->filter.cursor.timestamp, &es->filter.cursor.id) != 3) {
+                goto bad_cursor;
+            }
+            es->filter.after_cursor = true;
+        }
+    } else if (es->buffer) {
+        es->skip = (size_t)offset;
+        if (cursor_arg && cursor_arg[0] &&
+            sscanf(cursor_arg, "%lu.%lu", &es->timestamp, &es->sequence) != 2) {
+            goto bad_cursor;
+        }
+    } else {
+        es->limit = 0;
+    }
+    
+    if (!json_buf_init(&es->json, 32 * 1024)) {
+        api_events_close(es);
+        *status = 500;
+        return NULL;
+    }
+    
+    if (es->limit == 0) {
+        if (es->dict) {
+            event_cbor_append_end(&es->json, NULL, 0);
+        } else {
+            json_buf_append_str(&es->json, "{\"events\":[],\"next_cursor\":null,\"limit\":0}");
+        }
+        es->done = true;
+    } else if (events_fill(es) < 0) {
+        api_events_close(es);
+        *status = 500;
+        events_error(error, "Query failed");
+        return NULL;
+    }
+    
+    return es;
+    
+bad_cursor:
+    api_events_close(es);
+    *status = 400;
+    events_error(error, "Invalid cursor");
+    return NULL;
+    
+bad_filter:
+    api_events_close(es);
+    *status = 400;
+    events_error(error, "Invalid filter");
+    return NULL;
+}
+
+/* Copy out the next part of the listing, 0 at its end */
+ssize_t api_events_read(struct api_events_stream *es, char *buf, size_t max) {
+    size_t n = 0;
+    
+    while (n < max) {
+        if (es->pos == es->json.len) {
+            if (es->done) break;
+            
+            json_buf_reset(&es->json);
+            es->pos = 0;
+            
+            /* Headers are out, a failure can only cut the body short */
+            if (events_fill(es) < 0 || es->json.failed) return n ? (ssize_t)n : -1;
+        }
+        
+        size_t chunk = es->json.len - es->pos;
+        if (chunk > max - n) chunk = max - n;
+        
+        memcpy(buf + n, es->json.data + es->pos, chunk);
+        es->pos += chunk;
+        n += chunk;
+    }
+    
+    return (ssize_t)n;
+}
+
+void api_events_close(struct api_events_stream *es) {
+    if (!es) return;
+    
+    filter_bytecode_free(es->residual);
+    filter_expr_free(es->expr);
+    event_cbor_dict_destroy(es->dict);
+    json_buf_free(&es->json);
+    free(es);
+}
+
+/* Whether an Accept header takes the CBOR listing, not refused with q=0 */
+static bool accepts_cbor(const char *accept) {
+    const char *p = accept ? strstr(accept, EVENT_CBOR_MEDIA_TYPE) : NULL;
+    
+    if (!p) return false;
+    
+    p += strlen(EVENT_CBOR_MEDIA_TYPE);
+    for (const char *end = p + strcspn(p, ","); p < end; p++) {
+        if (strncmp(p, "q=", 2) == 0) return strtod(p + 2, NULL) > 0;
+    }
+    
+    return true;
+}
+
+static void *events_stream_open(void *user_data, struct web_request *request,
+                                int *status, char **error) {
+    bool cbor = accepts_cbor(web_request_header(request, "Accept"));
+    
+    if (cbor) web_request_set_content_type(request, EVENT_CBOR_MEDIA_TYPE);
+    
+    return api_events_open(user_data, web_request_arg(request, "limit"),
+                           web_request_arg(request, "offset"),
+                           web_request_arg(request, "cursor"),
+                           web_request_arg(request, "filter"),
+                           EVENTS_MAX_LIMIT, cbor, status, error);
+}
+
+static ssize_t events_stream_read(void *stream, char *buf, size_t max) {
+    return api_events_read(stream, buf, max);
+}
+
+static void events_stream_close(void *stream) {
+    api_events_close(stream);
+}
+
+#define PROFILE_DEFAULT_SECONDS 10
+
+/* Response built up front and streamed out, such as the folded stacks of
+ * GET /api/debug/profile */
+struct api_buffer_stream {
+    char *data;
+    size_t len;
+    size_t pos;
+};
+
+static ssize_t buffer_stream_read(void *stream, char *buf, size_t max) {
+    struct api_buffer_stream *bs = stream;
+    size_t n = bs->len - bs->pos;
+    
+    if (n > max) n = max;
+    memcpy(buf, bs->data + bs->pos, n);
+    bs->pos += n;
+    
+    return (ssize_t)n;
+}
+
+static void buffer_stream_close(void *stream) {
+    struct api_buffer_stream *bs = stream;
+    
+    free(bs->data);
+    free(bs);
+}
+
+/* Capture ?seconds of stacks at ?hz, blocking this connection meanwhile */
+static void *profile_stream_open(void *user_data, struct web_request *request,
+                                 int *status, char **error) {
+    struct web_api_context *ctx = user_data;
+    const char *seconds_arg = web_request_arg(request, "seconds");
+    const char *hz_arg = web_request_arg(request, "hz");
+    long seconds = seconds_arg ? atol(seconds_arg) : PROFILE_DEFAULT_SECONDS;
+    long hz = hz_arg ? atol(hz_arg) : 0;
+    
+    if (seconds <= 0 || seconds > STACK_SAMPLER_MAX_SECONDS ||
+        hz < 0 || hz > STACK_SAMPLER_MAX_HZ) {
+        *status = 400;
+        events_error(error, "Invalid seconds or hz");
+        return NULL;
+    }
+    
+    struct stack_profile *profile = stack_sampler_capture(seconds, hz);
+    if (!profile) {
+        bool busy = errno == EBUSY;
+        
+        *status = busy ? 409 : 500;
+        events_error(error, busy ? "Profile already running" : "Profile failed");
+        return NULL;
+    }
+    
+    /* Later bottleneck reports carry the CPU share of the operations */
+    if (ctx->profiler) performance_profiler_attach_samples(ctx->profiler, profile);
+    
+    struct api_buffer_stream *bs = calloc(1, sizeof(*bs));
+    if (bs) bs->data = stack_profile_folded(profile, &bs->len);
+    stack_profile_free(profile);
+    
+    if (!bs || !bs->data) {
+        free(bs);
+        *status = 500;
+        return NULL;
+    }
+    
+    return bs;
+}
+
+#define ROUTES_DEFAULT_LIMIT 1000
+#define ROUTES_MAX_LIMIT 100000
+
+/* Routes listing being built */
+struct api_routes_walk {
+    struct json_buf *json;
+    size_t limit;
+    size_t count;
+    bool truncated;
+};
+
+static bool routes_collect(const struct fib_mirror_route *route, void *ctx) {
+    struct api_routes_walk *walk = ctx;
+    struct json_buf *json = walk->json;
+    
+    if (walk->count == walk->limit) {
+        walk->truncated = true;
+        return false;
+    }
+    if (walk->count++) json_buf_append_char(json, ',');
+    
+    json_buf_append_str(json, "{\"dst\":");
+    json_buf_append_string(json, route->dst);
+    json_buf_append_str(json, ",\"dst_len\":");
+    json_buf_append_u64(json, route->dst_len);
+    json_buf_append_str(json, ",\"gateway\":");
+    if (route->gateway[0]) json_buf_append_string(json, route->gateway);
+    else json_buf_append_str(json, "null");
+    json_buf_append_str(json, ",\"oif\":");
+    json_buf_append_i64(json, route->oif);
+    json_buf_append_str(json, ",\"priority\":");
+    json_buf_append_u64(json, route->priority);
+    json_buf_append_str(json, ",\"table\":");
+    json_buf_append_u64(json, route->table);
+    json_buf_append_str(json, ",\"protocol\":");
+    json_buf_append_u64(json, route->protocol);
+    json_buf_append_str(json, ",\"type\":");
+    json_buf_append_u64(json, route->type);
+    json_buf_append_str(json, ",\"since\":");
+    json_buf_append_i64(json, route->since);
+    json_buf_append_char(json, '}');
+    
+    return true;
+}
+
+/* Routes of ?table, main by default, for GET /api/routes: those inside
+ * ?prefix, the longest match of ?addr, or all of them, at most ?limit.
+ * Answered from the route mirror, the kernel is not asked for a dump. */
+static void *routes_stream_open(void *user_data, struct web_request *request,
+                                int *status, char **error) {
+    struct web_api_context *ctx = user_data;
+    const char *table_arg = web_request_arg(request, "table");
+    const char *addr_arg = web_request_arg(request, "addr");
+    const char *prefix_arg = web_request_arg(request, "prefix");
+    const char *limit_arg = web_request_arg(request, "limit");
+    unsigned int table = table_arg ? (unsigned int)strtoul(table_arg, NULL, 10) : RT_TABLE_MAIN;
+    long limit = limit_arg ? atol(limit_arg) : ROUTES_DEFAULT_LIMIT;
+    struct api_routes_walk walk = { 0 };
+    struct fib_mirror_route route;
+    struct json_buf json;
+    char prefix[64] = "";
+    unsigned int prefix_len = 0;
+    int family = 0;
+    
+    if (!ctx->routes) {
+        *status = 503;
+        events_error(error, "Route mirror not available");
+        return NULL;
+    }
+    if (limit <= 0 || limit > ROUTES_MAX_LIMIT) {
+        *status = 400;
+        events_error(error, "Invalid limit");
+        return NULL;
+    }
+    
+    if (prefix_arg) {
+        const char *slash = strchr(prefix_arg, '/');
+        size_t len = slash ? (size_t)(slash - prefix_arg) : strlen(prefix_arg);
+        
+        if (len == 0 || len >= sizeof(prefix)) {
+            *status = 400;
+            events_error(error, "Invalid prefix");
+            return NULL;
+        }
+        memcpy(prefix, prefix_arg, len);
+        family = strchr(prefix, ':') ? AF_INET6 : AF_INET;
+        prefix_len = slash ? (unsigned int)atoi(slash + 1) : (family == AF_INET6 ? 128 : 32);
+    }
+    
+    if (!json_buf_init(&json, 4096)) {
+        *status = 500;
+        return NULL;
+    }
+    walk.json = &json;
+    walk.limit = (size_t)limit;
+    
+    json_buf_append_str(&json, "{\"routes\":[");
+    if (addr_arg) {
+        if (fib_mirror_lookup(ctx->routes, table, addr_arg, &route))
+            routes_collect(&route, &walk);
+    } else if (family) {
+        if (fib_mirror_walk(ctx->routes, table, family, prefix, prefix_len,
+                            routes_collect, &walk) < 0) {
+            json_buf_free(&json);
+            *status = 400;
+            events_error(error, "Invalid prefix");
+            return NULL;
+        }
+    } else {
+        fib_mirror_walk(ctx->routes, table, AF_INET, NULL, 0, routes_collect, &walk);
+        fib_mirror_walk(ctx->routes, table, AF_INET6, NULL, 0, routes_collect, &walk);
+    }
+    json_buf_append_str(&json, "],\"count\":");
+    json_buf_append_u64(&json, walk.count);
+    json_buf_append_str(&json, walk.truncated ? ",\"truncated\":true}" : ",\"truncated\":false}");
+    
+    struct api_buffer_stream *bs = calloc(1, sizeof(*bs));
+    if (bs) {
+        bs->len = json.len;
+        bs->data = json_buf_detach(&json);
+    } else {
+        json_buf_free(&json);
+    }
+    
+    if (!bs || !bs->data) {
+        free(bs);
+        *status = 500;
+        return NULL;
+    }
+    
+    return bs;
+}
+
+#define MIRROR_DEFAULT_LIMIT 1000
+#define MIRROR_MAX_LIMIT 100000
+
+/* Hand a listing over to a buffer stream, NULL with status 500 on error */
+static struct api_buffer_stream *mirror_stream(struct json_buf *json, int *status) {
+    struct api_buffer_stream *bs = calloc(1, sizeof(*bs));
+    
+    if (bs) {
+        bs->len = json->len;
+        bs->data = json_buf_detach(json);
+    } else {
+        json_buf_free(json);
+    }
+    
+    if (!bs || !bs->data) {
+        free(bs);
+        *status = 500;
+        return NULL;
+    }
+    
+    return bs;
+}
+
+/* Neighbors, flows or timeseries listing being built */
+struct api_mirror_walk {
+    struct json_buf *json;
+    size_t limit;
+    size_t count;
+    bool truncated;
+    bool keys;          /* Timeseries: write the key of each series */
+};
+
+static void json_append_lladdr(struct json_buf *json, const unsigned char *lladdr) {
+    static const unsigned char zero[6];
+    char text[18];
+    
+    if (memcmp(lladdr, zero, sizeof(zero)) == 0) {
+        json_buf_append_str(json, "null");
+        return;
+    }
+    snprintf(text, sizeof(text), "%02x:%02x:%02x:%02x:%02x:%02x",
+             lladdr[0], lladdr[1], lladdr[2], lladdr[3], lladdr[4], lladdr[5]);
+    json_buf_append_string(json, text);
+}
+
+static bool neighbors_collect(const struct neigh_mirror_entry *entry, void *ctx) {
+    struct api_mirror_walk *walk = ctx;
+    struct json_buf *json = walk->json;
+    
+    if (walk->count == walk->limit) {
+        walk->truncated = true;
+        return false;
+    }
+    if (walk->count++) json_buf_append_char(json, ',');
+    
+    json_buf_append_str(json, "{\"ifindex\":");
+    json_buf_append_i64(json, entry->ifindex);
+    json_buf_append_str(json, ",\"dst\":");
+    json_buf_append_string(json, entry->dst);
+    json_buf_append_str(json, ",\"lladdr\":");
+    json_append_lladdr(json, entry->lladdr);
+    json_buf_append_str(json, ",\"state\":");
+    json_buf_append_u64(json, entry->state);
+    json_buf_append_str(json, ",\"flags\":");
+    json_buf_append_u64(json, entry->flags);
+    json_buf_append_str(json, ",\"first_seen\":");
+    json_buf_append_i64(json, entry->first_seen);
+    json_buf_append_str(json, ",\"updated\":");
+    json_buf_append_i64(json, entry->updated);
+    json_buf_append_str(json, ",\"lladdr_changed\":");
+    json_buf_append_i64(json, entry->lladdr_changed);
+    json_buf_append_char(json, '}');
+    
+    return true;
+}
+
+/* Neighbors for GET /api/neighbors: the one of ?ifindex and ?addr, or at
+ * most ?limit of them, most recently updated first. Answered from the
+ * neighbor mirror. */
+static void *neighbors_stream_open(void *user_data, struct web_request *request,
+                                   int *status, char **error) {
+    struct web_api_context *ctx = user_data;
+    const char *ifindex_arg = web_request_arg(request, "ifindex");
+    const char *addr_arg = web_request_arg(request, "addr");
+    const char *limit_arg = web_request_arg(request, "limit");
+    long limit = limit_arg ? atol(limit_arg) : MIRROR_DEFAULT_LIMIT;
+    struct api_mirror_walk walk = { 0 };
+    struct neigh_mirror_entry entry;
+    struct json_buf json;
+    
+    if (!ctx->neighbors) {
+        *status = 503;
+        events_error(error, "Neighbor mirror not available");
+        return NULL;
+    }
+    if (limit <= 0 || limit > MIRROR_MAX_LIMIT) {
+        *status = 400;
+        events_error(error, "Invalid limit");
+        return NULL;
+    }
+    if (!ifindex_arg != !addr_arg) {
+        *status = 400;
+        events_error(error, "ifindex and addr go together");
+        return NULL;
+    }
+    
+    if (!json_buf_init(&json, 4096)) {
+        *status = 500;
+        return NULL;
+    }
+    walk.json = &json;
+    walk.limit = (size_t)limit;
+    
+    json_buf_append_str(&json, "{\"neighbors\":[");
+    if (addr_arg) {
+        if (neigh_mirror_lookup(ctx->neighbors, atoi(ifindex_arg), addr_arg, &entry))
+            neighbors_collect(&entry, &walk);
+    } else {
+        neigh_mirror_walk(ctx->neighbors, neighbors_collect, &walk);
+    }
+    json_buf_append_str(&json, "],\"count\":");
+    json_buf_append_u64(&json, walk.count);
+    json_buf_append_str(&json, walk.truncated ? ",\"truncated\":true}" : ",\"truncated\":false}");
+    
+    return mirror_stream(&json, status);
+}
+
+static bool flows_collect(const struct ct_mirror_entry *entry, void *ctx) {
+    struct api_mirror_walk *walk = ctx;
+    struct json_buf *json = walk->json;
+    
+    if (walk->count == walk->limit) {
+        walk->truncated = true;
+        return false;
+    }
+    if (walk->count++) json_buf_append_char(json, ',');
+    
+    json_buf_append_str(json, "{\"protocol\":");
+    json_buf_append_u64(json, entry->protocol);
+    json_buf_append_str(json, ",\"src\":");
+    json_buf_append_string(json, entry->src_addr);
+    json_buf_append_str(json, ",\"sport\":");
+    json_buf_append_u64(json, entry->src_port);
+    json_buf_append_str(json, ",\"dst\":");
+    json_buf_append_string(json, entry->dst_addr);
+    json_buf_append_str(json, ",\"dport\":");
+    json_buf_append_u64(json, entry->dst_port);
+    json_buf_append_str(json, ",\"tcp_state\":");
+    json_buf_append_u64(json, entry->tcp_state);
+    json_buf_append_str(json, ",\"mark\":");
+    json_buf_append_u64(json, entry->mark);
+    json_buf_append_str(json, ",\"packets_orig\":");
+    json_buf_append_u64(json, entry->packets_orig);
+    json_buf_append_str(json, ",\"packets_reply\":");
+    json_buf_append_u64(json, entry->packets_reply);
+    json_buf_append_str(json, ",\"bytes_orig\":");
+    json_buf_append_u64(json, entry->bytes_orig);
+    json_buf_append_str(json, ",\"bytes_reply\":");
+    json_buf_append_u64(json, entry->bytes_reply);
+    json_buf_append_str(json, ",\"first_seen\":");
+    json_buf_append_i64(json, entry->first_seen);
+    json_buf_append_str(json, ",\"updated\":");
+    json_buf_append_i64(json, entry->updated);
+    json_buf_append_char(json, '}');
+    
+    return true;
+}
+
+/* Flows for GET /api/conntrack: the one of ?proto, ?src, ?sport, ?dst and
+ * ?dport, or at most ?limit of them, most recently updated first. Answered
+ * from the conntrack mirror. */
+static void *conntrack_stream_open(void *user_data, struct web_request *request,
+                                   int *status, char **error) {
+    struct web_api_context *ctx = user_data;
+    const char *proto_arg = web_request_arg(request, "proto");
+    const char *src_arg = web_request_arg(request, "src");
+    const char *sport_arg = web_request_arg(request, "sport");
+    const char *dst_arg = web_request_arg(request, "dst");
+    const char *dport_arg = web_request_arg(request, "dport");
+    const char *limit_arg = web_request_arg(request, "limit");
+    long limit = limit_arg ? atol(limit_arg) : MIRROR_DEFAULT_LIMIT;
+    struct api_mirror_walk walk = { 0 };
+    struct ct_mirror_entry entry;
+    struct nlmon_ct_info tuple;
+    struct json_buf json;
+    bool lookup = proto_arg || src_arg || sport_arg || dst_arg || dport_arg;
+    
+    if (!ctx->flows) {
+        *status = 503;
+        events_error(error, "Conntrack mirror not available");
+        return NULL;
+    }
+    if (limit <= 0 || limit > MIRROR_MAX_LIMIT) {
+        *status = 400;
+        events_error(error, "Invalid limit");
+        return NULL;
+    }
+    if (lookup && !(proto_arg && src_arg && sport_arg && dst_arg && dport_arg)) {
+        *status = 400;
+        events_error(error, "proto, src, sport, dst and dport go together");
+        return NULL;
+    }
+    
+    if (!json_buf_init(&json, 4096)) {
+        *status = 500;
+        return NULL;
+    }
+    walk.json = &json;
+    walk.limit = (size_t)limit;
+    
+    json_buf_append_str(&json, "{\"flows\":[");
+    if (lookup) {
+        memset(&tuple, 0, sizeof(tuple));
+        tuple.protocol = (uint8_t)atoi(proto_arg);
+        snprintf(tuple.src_addr, sizeof(tuple.src_addr), "%s", src_arg);
+        snprintf(tuple.dst_addr, sizeof(tuple.dst_addr), "%s", dst_arg);
+        tuple.src_port = (uint16_t)atoi(sport_arg);
+        tuple.dst_port = (uint16_t)atoi(dport_arg);
+        if (ct_mirror_lookup(ctx->flows, &tuple, &entry))
+            flows_collect(&entry, &walk);
+    } else {
+        ct_mirror_walk(ctx->flows, flows_collect, &walk);
+    }
+    json_buf_append_str(&json, "],\"count\":");
+    json_buf_append_u64(&json, walk.count);
+    json_buf_append_str(&json, walk.truncated ? ",\"truncated\":true}" : ",\"truncated\":false}");
+    
+    return mirror_stream(&json, status);
+}
+
+#define TIMESERIES_DEFAULT_LIMIT 1000
+#define TIMESERIES_MAX_LIMIT 100000
+
+static void timeseries_collect(const struct rollup_series *series, void *ctx) {
+    struct api_mirror_walk *walk = ctx;
+    struct json_buf *json = walk->json;
+    
+    if (walk->count == walk->limit) {
+        walk->truncated = true;
+        return;
+    }
+    if (walk->count++) json_buf_append_char(json, ',');
+    
+    json_buf_append_char(json, '{');
+    if (series->key.overflow) {
+        json_buf_append_str(json, "\"overflow\":true,");
+    } else if (walk->keys) {
+        json_buf_append_str(json, "\"event_type\":");
+        json_buf_append_u64(json, series->key.event_type);
+        json_buf_append_str(json, ",\"interface\":");
+        json_buf_append_string(json, series->key.interface);
+        json_buf_append_str(json, ",\"netns\":");
+        json_buf_append_u64(json, series->key.netns);
+        json_buf_append_char(json, ',');
+    }
+    json_buf_append_str(json, "\"start\":");
+    json_buf_append_u64(json, series->start);
+    json_buf_append_str(json, ",\"total\":");
+    json_buf_append_u64(json, series->total);
+    json_buf_append_str(json, ",\"points\":[");
+    for (size_t i = 0; i < series->num_points; i++) {
+        if (i) json_buf_append_char(json, ',');
+        json_buf_append_u64(json, series->points[i]);
+    }
+    json_buf_append_str(json, "]}");
+}
+
+/* Event counts per ?resolution (1s, 1m or 1h) from ?from to ?to, seconds
+ * since the epoch, of the series matching ?type, ?interface and ?netns,
+ * added up into one with ?sum=1 */
+static void *timeseries_stream_open(void *user_data, struct web_request *request,
+                                    int *status, char **error) {
+    struct web_api_context *ctx = user_data;
+    struct storage_rollup *rollup = storage_layer_get_rollup(ctx->storage);
+    const char *resolution_arg = web_request_arg(request, "resolution");
+    const char *from_arg = web_request_arg(request, "from");
+    const char *to_arg = web_request_arg(request, "to");
+    const char *type_arg = web_request_arg(request, "type");
+    const char *netns_arg = web_request_arg(request, "netns");
+    const char *sum_arg = web_request_arg(request, "sum");
+    const char *limit_arg = web_request_arg(request, "limit");
+    long limit = limit_arg ? atol(limit_arg) : TIMESERIES_DEFAULT_LIMIT;
+    struct rollup_query query = { .resolution = ROLLUP_MINUTE };
+    struct api_mirror_walk walk = { 0 };
+    struct json_buf json;
+    
+    if (!rollup) {
+        *status = 503;
+        events_error(error, "Rollup not available");
+        return NULL;
+    }
+    if (limit <= 0 || limit > TIMESERIES_MAX_LIMIT) {
+        *status = 400;
+        events_error(error, "Invalid limit");
+        return NULL;
+    }
+    if (resolution_arg) {
+        if (strcmp(resolution_arg, "1s") == 0) {
+            query.resolution = ROLLUP_SECOND;
+        } else if (strcmp(resolution_arg, "1h") == 0) {
+            query.resolution = ROLLUP_HOUR;
+        } else if (strcmp(resolution_arg, "1m") != 0) {
+            *status = 400;
+            events_error(error, "Invalid resolution");
+            return NULL;
+        }
+    }
+    
+    query.start = from_arg ? strtoull(from_arg, NULL, 10) : 0;
+    query.end = to_arg ? strtoull(to_arg, NULL, 10) : 0;
+    if (query.end && query.end <= query.start) {
+        *status = 400;
+        events_error(error, "Invalid range");
+        return NULL;
+    }
+    query.match_type = type_arg != NULL;
+    query.event_type = type_arg ? (uint32_t)strtoul(type_arg, NULL, 10) : 0;
+    query.interface = web_request_arg(request, "interface");
+    query.match_netns = netns_arg != NULL;
+    query.netns = netns_arg ? strtoull(netns_arg, NULL, 10) : 0;
+    query.sum = sum_arg && strcmp(sum_arg, "0") != 0;
+    
+    if (!json_buf_init(&json, 4096)) {
+        *status = 500;
+        return NULL;
+    }
+    walk.json = &json;
+    walk.limit = (size_t)limit;
+    walk.keys = !query.sum;
+    
+    json_buf_append_str(&json, "{\"step\":");
+    json_buf_append_u64(&json, storage_rollup_step(query.resolution));
+    json_buf_append_str(&json, ",\"series\":[");
+    storage_rollup_query(rollup, &query, timeseries_collect, &walk);
+    json_buf_append_str(&json, "],\"count\":");
+    json_buf_append_u64(&json, walk.count);
+    json_buf_append_str(&json, walk.truncated ? ",\"truncated\":true}" : ",\"truncated\":false}");
+    
+    return mirror_stream(&json, status);
+}
+
+#define QUERY_MAX_LIMIT 100000
+#define QUERY_MAX_TIMEOUT_MS 60000
+
+static void query_append_row(struct json_buf *json, const struct query_row *row, uint32_t columns) {
+    bool first = true;
+    
+    json_buf_append_char(json, '{');
+    for (int col = 0; col < QUERY_COLUMNS; col++) {
+        if (!(columns & QUERY_COL_BIT(col))) continue;
+        if (!first) json_buf_append_char(json, ',');
+        first = false;
+        
+        json_buf_append_string(json, storage_query_column_name(col));
+        json_buf_append_char(json, ':');
+        switch (col) {
+        case QUERY_COL_TIMESTAMP:
+            json_buf_append_u64(json, row->timestamp);
+            break;
+        case QUERY_COL_SEQUENCE:
+            json_buf_append_u64(json, row->sequence);
+            break;
+        case QUERY_COL_EVENT_TYPE:
+            json_buf_append_u64(json, row->event_type);
+            break;
+        case QUERY_COL_MESSAGE_TYPE:
+            json_buf_append_u64(json, row->message_type);
+            break;
+        case QUERY_COL_INTERFACE:
+            json_buf_append_string(json, row->interface);
+            break;
+        }
+    }
+    json_buf_append_str(json, first ? "\"count\":" : ",\"count\":");
+    json_buf_append_u64(json, row->count);
+    json_buf_append_char(json, '}');
+}
+
+/* Ad-hoc query over the segment log, or the buffer without one: events
+ * matching ?filter from ?from to ?to, seconds since the epoch, projected to
+ * ?columns, or counted by ?group with timestamps in ?bucket seconds and the
+ * ?top largest groups kept. ?timeout in ms and ?memory in MB bound it. */
+static void *query_stream_open(void *user_data, struct web_request *request,
+                               int *status, char **error) {
+    struct web_api_context *ctx = user_data;
+    struct storage_log *log = storage_layer_get_log(ctx->storage);
+    struct storage_buffer *buffer = ctx->storage ? storage_layer_get_buffer(ctx->storage) : NULL;
+    const char *from_arg = web_request_arg(request, "from");
+    const char *to_arg = web_request_arg(request, "to");
+    const char *bucket_arg = web_request_arg(request, "bucket");
+    const char *top_arg = web_request_arg(request, "top");
+    const char *limit_arg = web_request_arg(request, "limit");
+    const char *timeout_arg = web_request_arg(request, "timeout");
+    const char *memory_arg = web_request_arg(request, "memory");
+    long limit = limit_arg ? atol(limit_arg) : QUERY_DEFAULT_LIMIT;
+    long timeout = timeout_arg ? atol(timeout_arg) : QUERY_DEFAULT_TIMEOUT_MS;
+    struct storage_query query = { 0 };
+    struct storage_query_result result;
+    uint32_t columns;
+    struct json_buf json;
+    
+    if (!log && !buffer) {
+        *status = 503;
+        events_error(error, "Storage not available");
+        return NULL;
+    }
+    if (limit <= 0 || limit > QUERY_MAX_LIMIT) {
+        *status = 400;
+        events_error(error, "Invalid limit");
+        return NULL;
+    }
+    if (timeout <= 0 || timeout > QUERY_MAX_TIMEOUT_MS) {
+        *status = 400;
+        events_error(error, "Invalid timeout");
+        return NULL;
+    }
+    if (!storage_query_parse_columns(web_request_arg(request, "columns"), &query.columns) ||
+        !storage_query_parse_columns(web_request_arg(request, "group"), &query.group_by)) {
+        *status = 400;
+        events_error(error, "Invalid column");
+        return NULL;
+    }
+    
+    query.filter = web_request_arg(request, "filter");
+    query.start_time = from_arg ? strtoull(from_arg, NULL, 10) * 1000000000ULL : 0;
+    query.end_time = to_arg ? strtoull(to_arg, NULL, 10) * 1000000000ULL : 0;
+    if (query.end_time && query.end_time < query.start_time) {
+        *status = 400;
+        events_error(error, "Invalid range");
+        return NULL;
+    }
+    query.bucket_ns = bucket_arg ? strtoull(bucket_arg, NULL, 10) * 1000000000ULL : 0;
+    query.top_k = top_arg ? strtoul(top_arg, NULL, 10) : 0;
+    query.limit = (size_t)limit;
+    query.timeout_ms = (unsigned int)timeout;
+    query.max_memory = memory_arg ? strtoul(memory_arg, NULL, 10) * 1024 * 1024 : 0;
+    
+    switch (storage_query_run(log, log ? NULL : buffer, &query, &result)) {
+    case QUERY_OK:
+        break;
+    case QUERY_INVALID:
+        *status = 400;
+        events_error(error, "Invalid filter expression");
+        return NULL;
+    case QUERY_TIMEOUT:
+        *status = 504;
+        events_error(error, "Query timed out");
+        return NULL;
+    case QUERY_MEMORY:
+        *status = 503;
+        events_error(error, "Query memory limit reached");
+        return NULL;
+    default:
+        *status = 500;
+        return NULL;
+    }
+    
+    if (!json_buf_init(&json, 4096)) {
+        storage_query_result_free(&result);
+        *status = 500;
+        return NULL;
+    }
+    
+    columns = query.group_by ? query.group_by : (query.columns ? query.columns : QUERY_COL_ALL);
+    json_buf_append_str(&json, "{\"rows\":[");
+    for (size_t i = 0; i < result.num_rows; i++) {
+        if (i) json_buf_append_char(&json, ',');
+        query_append_row(&json, &result.rows[i], columns);
+    }
+    json_buf_append_str(&json, "],\"count\":");
+    json_buf_append_u64(&json, result.num_rows);
+    json_buf_append_str(&json, result.truncated ? ",\"truncated\":true" : ",\"truncated\":false");
+    json_buf_append_str(&json, ",\"scanned\":");
+    json_buf_append_u64(&json, result.scanned);
+    json_buf_append_str(&json, ",\"matched\":");
+    json_buf_append_u64(&json, result.matched);
+    json_buf_append_str(&json, ",\"partitions\":");
+    json_buf_append_u64(&json, result.partitions);
+    json_buf_append_str(&json, ",\"elapsed_us\":");
+    json_buf_append_u64(&json, result.elapsed_us);
+    json_buf_append_char(&json, '}');
+    storage_query_result_free(&result);
+    
+    return mirror_stream(&json, status);
+}
+
+/* GET /api/events - List events, buffered
+ *
+ * The registered route streams the same listing, this answers with one
+ * buffer of at most EVENTS_BUFFERED_LIMIT events.
+ */
+int api_get_events(void *cls, const char *url, const char *method,
+                   const char *version, const char *upload_data,
+                   size_t *upload_data_size, void **con_cls,
+                   char **response, size_t *response_len,
+                   const char **content_type) {
+    struct web_api_context *ctx = cls;
+    char limit_str[32] = "";
+    char offset_str[32] = "";
+    char cursor_str[96] = "";
+    struct json_buf json;
+    char chunk[4096];
+    int status = 200;
+    char *error = NULL;
+    ssize_t n;
+    
+    parse_query_param(url, "limit", limit_str, sizeof(limit_str));
+    parse_query_param(url, "offset", offset_str, sizeof(offset_str));
+    parse_query_param(url, "cursor", cursor_str, sizeof(cursor_str));
     
-    *response = json;
-    *response_len = pos;
     *content_type = "application/json";
     
+    struct api_events_stream *es = api_events_open(ctx, limit_str[0] ? limit_str : NULL,
+                                                   offset_str, cursor_str, NULL,
+                                                   EVENTS_BUFFERED_LIMIT, false, &status, &error);
+    if (!es) {
+        if (!error) return -1;
+        *response = error;
+        *response_len = strlen(error);
+        return status;
+    }
+    
+    if (!json_buf_init(&json, sizeof(chunk))) {
+        api_events_close(es);
+        return -1;
+    }
+    
+    while ((n = api_events_read(es, chunk, sizeof(chunk))) > 0) {
+        json_buf_append(&json, chunk, (size_t)n);
+    }
+    api_events_close(es);
+    
+    *response_len = json.len;
+    *response = json_buf_detach(&json);
+    if (n < 0 || !*response) {
+        free(*response);
+        return -1;
+    }
+    
     return 200;
 }
 
@@ -159,14 +1207,159 @@ int api_get_event_by_id(void *cls, const char *url, const char *method,
     return 200;
 }
 
-/* GET /api/stats - Get statistics */
-int api_get_stats(void *cls, const char *url, const char *method,
-                  const char *version, const char *upload_data,
-                  size_t *upload_data_size, void **con_cls,
-                  char **response, size_t *response_len,
-                  const char **content_type) {
-    struct web_api_context *ctx = cls;
-    (void)ctx; /* Reserved for future use */
+#define STATS_INTERVAL_MS 1000
+
+/* Statistics snapshots are shared by all requests of one interval, or of
+ * one stats bus snapshot */
+static uint64_t stats_version(void *user_data) {
+    struct web_api_context *ctx = user_data;
+    unsigned int interval = ctx->stats_interval_ms ? ctx->stats_interval_ms : STATS_INTERVAL_MS;
+    struct timespec ts;
+    
+    if (ctx->stats_bus) return stats_bus_generation(ctx->stats_bus);
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return ((uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000) / interval;
+}
+
+/* Append a "name":value member */
+static void stats_member(struct json_buf *json, const char *name, uint64_t value, bool last) {
+    json_buf_append_char(json, '"');
+    json_buf_append_str(json, name);
+    json_buf_append_str(json, "\":");
+    json_buf_append_u64(json, value);
+    if (!last) json_buf_append_char(json, ',');
+}
+
+/* Build the /api/stats body from the latest stats bus snapshot */
+static int build_bus_stats(struct stats_bus *bus, char **body, size_t *len) {
+    struct nlmon_stats_snapshot snap;
+    struct json_buf json;
+    
+    if (!stats_bus_read(bus, &snap)) return -1;
+    if (!json_buf_init(&json, 4096)) return -1;
+    
+    json_buf_append_str(&json, "{\"stats\":{");
+    stats_member(&json, "generation", snap.generation, false);
+    stats_member(&json, "timestamp_ms", snap.timestamp_ms, false);
+    stats_member(&json, "collect_ns", snap.collect_ns, !snap.have);
+    
+    if (snap.have & STATS_HAVE_EVENTS) {
+        json_buf_append_str(&json, "\"events\":{");
+        stats_member(&json, "submitted", snap.events.submitted, false);
+        stats_member(&json, "processed", snap.events.processed, false);
+        stats_member(&json, "dropped", snap.events.dropped, false);
+        stats_member(&json, "rate_limited", snap.events.rate_limited, false);
+        stats_member(&json, "queue_size", snap.events.queue_size, false);
+        stats_member(&json, "pool_usage", snap.events.pool_usage, true);
+        json_buf_append_str(&json, "},");
+    }
+    if (snap.have & STATS_HAVE_THREAD_POOL) {
+        json_buf_append_str(&json, "\"thread_pool\":{");
+        stats_member(&json, "submitted", snap.thread_pool.submitted, false);
+        stats_member(&json, "completed", snap.thread_pool.completed, false);
+        stats_member(&json, "rejected", snap.thread_pool.rejected, false);
+        stats_member(&json, "threads", snap.thread_pool.threads, false);
+        stats_member(&json, "pending", snap.thread_pool.pending, true);
+        json_buf_append_str(&json, "},");
+    }
+    if (snap.have & STATS_HAVE_STORAGE) {
+        json_buf_append_str(&json, "\"storage\":{");
+        stats_member(&json, "buffer_size", snap.storage.buffer_size, false);
+        stats_member(&json, "buffer_capacity", snap.storage.buffer_capacity, false);
+        stats_member(&json, "db_event_count", snap.storage.db_event_count, false);
+        stats_member(&json, "db_size_bytes", snap.storage.db_size_bytes, false);
+        stats_member(&json, "audit_entries", snap.storage.audit_entries, true);
+        json_buf_append_str(&json, "},");
+    }
+    if (snap.have & STATS_HAVE_EXPORT) {
+        bool first = true;
+        
+        json_buf_append_str(&json, "\"export\":[");
+        for (int i = 0; i < STATS_BUS_MAX_EXPORTS; i++) {
+            const struct stats_export *q = &snap.exports[i];
+            
+            if (!(snap.exports_enabled & (1u << i))) continue;
+            json_buf_append_str(&json, first ? "{" : ",{");
+            first = false;
+            stats_member(&json, "target", i, false);
+            stats_member(&json, "queued", q->queued, false);
+            stats_member(&json, "exported", q->exported, false);
+            stats_member(&json, "failed", q->failed, false);
+            stats_member(&json, "dropped", q->dropped, false);
+            stats_member(&json, "sampled", q->sampled, false);
+            stats_member(&json, "queue_depth", q->queue_depth, false);
+            stats_member(&json, "lag_us", q->lag_us, true);
+            json_buf_append_char(&json, '}');
+        }
+        json_buf_append_str(&json, "],");
+    }
+    if (snap.have & STATS_HAVE_NETLINK) {
+        json_buf_append_str(&json, "\"netlink\":{");
+        stats_member(&json, "messages", snap.netlink.total_messages_processed, false);
+        stats_member(&json, "dropped", snap.netlink.total_messages_dropped, false);
+        stats_member(&json, "bytes", snap.netlink.total_bytes_processed, false);
+        stats_member(&json, "messages_per_sec", snap.netlink.messages_per_sec, false);
+        stats_member(&json, "socket_buffer_drops", snap.netlink.socket_buffer_drops, false);
+        stats_member(&json, "memory_bytes", snap.netlink.current_memory_bytes, true);
+        json_buf_append_str(&json, "},");
+    }
+    if (snap.have & STATS_HAVE_PLUGINS) {
+        json_buf_append_str(&json, "\"plugins\":[");
+        for (size_t i = 0; i < snap.num_plugins; i++) {
+            json_buf_append_str(&json, i ? ",{\"name\":" : "{\"name\":");
+            json_buf_append_string(&json, snap.plugins[i].name);
+            json_buf_append_char(&json, ',');
+            stats_member(&json, "events_processed", snap.plugins[i].events_processed, false);
+            stats_member(&json, "events_dropped", snap.plugins[i].events_dropped, false);
+            stats_member(&json, "queue_depth", snap.plugins[i].queue_depth, true);
+            json_buf_append_char(&json, '}');
+        }
+        json_buf_append_str(&json, "],");
+    }
+    if (snap.have & STATS_HAVE_BATCHING) {
+        json_buf_append_str(&json, "\"batching\":[");
+        for (size_t i = 0; i < snap.num_batches; i++) {
+            const struct stats_batch *b = &snap.batches[i];
+            
+            json_buf_append_str(&json, i ? ",{\"stage\":" : "{\"stage\":");
+            json_buf_append_string(&json, b->name);
+            json_buf_append_char(&json, ',');
+            stats_member(&json, "size", b->size, false);
+            stats_member(&json, "linger_us", b->linger_us, false);
+            stats_member(&json, "target_us", b->target_us, false);
+            stats_member(&json, "latency_us", b->latency_us, false);
+            stats_member(&json, "batches", b->batches, false);
+            stats_member(&json, "items", b->items, false);
+            stats_member(&json, "over_target", b->over_target, true);
+            json_buf_append_char(&json, '}');
+        }
+        json_buf_append_str(&json, "],");
+    }
+    if (snap.have & STATS_HAVE_HUGEPAGES) {
+        json_buf_append_str(&json, "\"hugepages\":{");
+        stats_member(&json, "regions", snap.hugepages.regions, false);
+        stats_member(&json, "bytes", snap.hugepages.bytes, false);
+        stats_member(&json, "huge_bytes", snap.hugepages.huge_bytes, true);
+        json_buf_append_str(&json, "},");
+    }
+    
+    /* Every part ends in a comma */
+    if (snap.have) json.len--;
+    json_buf_append_str(&json, "}}");
+    
+    *len = json.len;
+    *body = json_buf_detach(&json);
+    
+    return *body ? 0 : -1;
+}
+
+/* Build the /api/stats body */
+static int build_stats(void *user_data, char **body, size_t *len) {
+    struct web_api_context *ctx = user_data;
+    
+    if (ctx->stats_bus) return build_bus_stats(ctx->stats_bus, body, len);
     
     /* Build JSON response */
     char *json = malloc(4096);
@@ -192,20 +1385,35 @@ int api_get_stats(void *cls, const char *url, const char *method,
         "}}",
         time(NULL));
     
-    *response = json;
-    *response_len = pos;
+    *body = json;
+    *len = pos;
+    
+    return 0;
+}
+
+/* GET /api/stats - Get statistics */
+int api_get_stats(void *cls, const char *url, const char *method,
+                  const char *version, const char *upload_data,
+                  size_t *upload_data_size, void **con_cls,
+                  char **response, size_t *response_len,
+                  const char **content_type) {
+    if (build_stats(cls, response, response_len) < 0) return -1;
+    
     *content_type = "application/json";
     
     return 200;
 }
 
-/* GET /api/config - Get configuration */
-int api_get_config(void *cls, const char *url, const char *method,
-                   const char *version, const char *upload_data,
-                   size_t *upload_data_size, void **con_cls,
-                   char **response, size_t *response_len,
-                   const char **content_type) {
-    struct web_api_context *ctx = cls;
+/* Configuration snapshots last until a reload, built once without a context */
+static uint64_t config_version(void *user_data) {
+    struct web_api_context *ctx = user_data;
+    
+    return ctx->config_ctx ? nlmon_config_get_version(ctx->config_ctx) : 0;
+}
+
+/* Build the /api/config body */
+static int build_config(void *user_data, char **body, size_t *len) {
+    struct web_api_context *ctx = user_data;
     (void)ctx; /* Reserved for future use */
     
     /* Build JSON response with current config */
@@ -229,8 +1437,20 @@ int api_get_config(void *cls, const char *url, const char *method,
         "}"
         "}}");
     
-    *response = json;
-    *response_len = pos;
+    *body = json;
+    *len = pos;
+    
+    return 0;
+}
+
+/* GET /api/config - Get configuration */
+int api_get_config(void *cls, const char *url, const char *method,
+                   const char *version, const char *upload_data,
+                   size_t *upload_data_size, void **con_cls,
+                   char **response, size_t *response_len,
+                   const char **content_type) {
+    if (build_config(cls, response, response_len) < 0) return -1;
+    
     *content_type = "application/json";
     
     return 200;
@@ -260,14 +1480,54 @@ int api_update_config(void *cls, const char *url, const char *method,
     return 200;
 }
 
-/* GET /api/filters - List filters */
-int api_get_filters(void *cls, const char *url, const char *method,
-                    const char *version, const char *upload_data,
-                    size_t *upload_data_size, void **con_cls,
-                    char **response, size_t *response_len,
-                    const char **content_type) {
-    struct web_api_context *ctx = cls;
-    (void)ctx; /* Reserved for future use */
+#define FILTERS_MAX_LISTED 1024
+
+/* Filter listings last until the filter manager publishes a change */
+static uint64_t filters_version(void *user_data) {
+    struct web_api_context *ctx = user_data;
+    
+    return filter_manager_get_version(ctx->filter_mgr);
+}
+
+/* Build the /api/filters body from the filter manager */
+static int build_filters_listing(struct filter_manager *mgr, char **body, size_t *len) {
+    const char *names[FILTERS_MAX_LISTED];
+    struct json_buf json;
+    size_t count;
+    
+    count = filter_manager_list(mgr, names, FILTERS_MAX_LISTED);
+    if (count > FILTERS_MAX_LISTED) count = FILTERS_MAX_LISTED;
+    
+    if (!json_buf_init(&json, 256 + count * 128)) return -1;
+    
+    json_buf_append_str(&json, "{\"filters\":[");
+    for (size_t i = 0; i < count; i++) {
+        struct filter_entry *entry = filter_manager_get(mgr, names[i]);
+        if (!entry) continue;
+        
+        json_buf_append_str(&json, i ? ",{\"id\":" : "{\"id\":");
+        json_buf_append_u64(&json, i + 1);
+        json_buf_append_str(&json, ",\"name\":");
+        json_buf_append_string(&json, entry->name);
+        json_buf_append_str(&json, ",\"expression\":");
+        json_buf_append_string(&json, entry->expression);
+        json_buf_append_str(&json, ",\"description\":");
+        json_buf_append_string(&json, entry->description);
+        json_buf_append_str(&json, entry->enabled ? ",\"enabled\":true}" : ",\"enabled\":false}");
+    }
+    json_buf_append_str(&json, "]}");
+    
+    *len = json.len;
+    *body = json_buf_detach(&json);
+    
+    return *body ? 0 : -1;
+}
+
+/* Build the /api/filters body */
+static int build_filters(void *user_data, char **body, size_t *len) {
+    struct web_api_context *ctx = user_data;
+    
+    if (ctx->filter_mgr) return build_filters_listing(ctx->filter_mgr, body, len);
     
     char *json = malloc(4096);
     if (!json) return -1;
@@ -280,8 +1540,20 @@ int api_get_filters(void *cls, const char *url, const char *method,
         "\"expression\":\"interface == 'eth0'\",\"enabled\":false}"
         "]}");
     
-    *response = json;
-    *response_len = pos;
+    *body = json;
+    *len = pos;
+    
+    return 0;
+}
+
+/* GET /api/filters - List filters */
+int api_get_filters(void *cls, const char *url, const char *method,
+                    const char *version, const char *upload_data,
+                    size_t *upload_data_size, void **con_cls,
+                    char **response, size_t *response_len,
+                    const char **content_type) {
+    if (build_filters(cls, response, response_len) < 0) return -1;
+    
     *content_type = "application/json";
     
     return 200;
@@ -346,14 +1618,31 @@ int web_api_init(struct web_server *server, struct web_api_context *ctx) {
     if (!server || !ctx) return -1;
     
     /* Register API endpoints */
-    web_server_register_route(server, "/api/events", "GET", api_get_events, ctx);
+    web_server_register_stream(server, "/api/events", "application/json",
+                               events_stream_open, events_stream_read, events_stream_close, ctx);
     web_server_register_route(server, "/api/events/", "GET", api_get_event_by_id, ctx);
-    web_server_register_route(server, "/api/stats", "GET", api_get_stats, ctx);
-    web_server_register_route(server, "/api/config", "GET", api_get_config, ctx);
+    web_server_register_resource(server, "/api/stats", "application/json",
+                                 stats_version, build_stats, ctx);
+    web_server_register_resource(server, "/api/config", "application/json",
+                                 config_version, build_config, ctx);
     web_server_register_route(server, "/api/config", "PUT", api_update_config, ctx);
-    web_server_register_route(server, "/api/filters", "GET", api_get_filters, ctx);
+    web_server_register_resource(server, "/api/filters", "application/json",
+                                 filters_version, build_filters, ctx);
     web_server_register_route(server, "/api/filters", "POST", api_create_filter, ctx);
     web_server_register_route(server, "/api/alerts", "GET", api_get_alerts, ctx);
+    web_server_register_stream(server, "/api/routes", "application/json",
+                               routes_stream_open, buffer_stream_read, buffer_stream_close, ctx);
+    web_server_register_stream(server, "/api/neighbors", "application/json",
+                               neighbors_stream_open, buffer_stream_read, buffer_stream_close, ctx);
+    web_server_register_stream(server, "/api/conntrack", "application/json",
+                               conntrack_stream_open, buffer_stream_read, buffer_stream_close, ctx);
+    web_server_register_stream(server, "/api/timeseries", "application/json",
+                               timeseries_stream_open, buffer_stream_read, buffer_stream_close, ctx);
+    web_server_register_stream(server, "/api/query", "application/json",
+                               query_stream_open, buffer_stream_read, buffer_stream_close, ctx);
+    web_server_register_stream(server, "/api/debug/profile", "text/plain",
+                               profile_stream_open, buffer_stream_read, buffer_stream_close,
+                               ctx);
     
     return 0;
 }
@@ -1,4 +1,5 @@
 #include "web_auth.h"
+#include "auth_cache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,6 +20,8 @@ struct web_auth_context {
     int num_users;
     struct web_session sessions[MAX_SESSIONS];
     int num_sessions;
+    struct auth_cache *session_cache;   /* Validated session tokens */
+    struct auth_cache *jwt_cache;       /* Verified JWTs */
 };
 
 /* Base64 encode */
@@ -76,12 +79,23 @@ struct web_auth_context *web_auth_init(const char *secret_key) {
     ctx->num_users = 0;
     ctx->num_sessions = 0;
     
+    ctx->session_cache = auth_cache_create(0, 0);
+    ctx->jwt_cache = auth_cache_create(0, 0);
+    if (!ctx->session_cache || !ctx->jwt_cache) {
+        auth_cache_destroy(ctx->session_cache);
+        auth_cache_destroy(ctx->jwt_cache);
+        free(ctx);
+        return NULL;
+    }
+    
     return ctx;
 }
 
 /* Cleanup authentication system */
 void web_auth_cleanup(struct web_auth_context *ctx) {
     if (ctx) {
+        auth_cache_destroy(ctx->session_cache);
+        auth_cache_destroy(ctx->jwt_cache);
         free(ctx);
     }
 }
@@ -192,6 +206,15 @@ int web_auth_validate_token(struct web_auth_context *ctx, const char *token,
                             char *username, size_t username_len) {
     if (!ctx || !token) return -1;
     
+    struct auth_identity identity;
+    if (auth_cache_lookup(ctx->session_cache, token, &identity)) {
+        if (username) {
+            snprintf(username, username_len, "%s", identity.username);
+        }
+        return 0;
+    }
+    
+    uint64_t generation = auth_cache_generation(ctx->session_cache);
     time_t now = time(NULL);
     
     for (int i = 0; i < ctx->num_sessions; i++) {
@@ -207,6 +230,14 @@ int web_auth_validate_token(struct web_auth_context *ctx, const char *token,
                 snprintf(username, username_len, "%s", session->username);
             }
             
+            memset(&identity, 0, sizeof(identity));
+            snprintf(identity.username, sizeof(identity.username), "%s", session->username);
+            struct web_user *user = find_user(ctx, session->username);
+            if (user) {
+                snprintf(identity.role, sizeof(identity.role), "%s", user->role);
+            }
+            auth_cache_insert(ctx->session_cache, token, &identity, session->expires, generation);
+            
             return 0;
         }
     }
@@ -221,6 +252,7 @@ int web_auth_logout(struct web_auth_context *ctx, const char *token) {
     for (int i = 0; i < ctx->num_sessions; i++) {
         if (strcmp(ctx->sessions[i].token, token) == 0) {
             ctx->sessions[i].active = 0;
+            auth_cache_invalidate(ctx->session_cache, token);
             return 0;
         }
     }
@@ -294,6 +326,17 @@ int web_auth_verify_jwt(struct web_auth_context *ctx, const char *token,
                         char *role, size_t role_len) {
     if (!ctx || !token) return -1;
     
+    /* Tokens that verified skip the signature check until they expire */
+    struct auth_identity identity;
+    if (auth_cache_lookup(ctx->jwt_cache, token, &identity)) {
+        if (username) snprintf(username, username_len, "%s", identity.username);
+        if (role) snprintf(role, role_len, "%s", identity.role);
+        return 0;
+    }
+    
+    uint64_t generation = auth_cache_generation(ctx->jwt_cache);
+    memset(&identity, 0, sizeof(identity));
+    
     /* Split token into parts */
     char *token_copy = strdup(token);
     if (!token_copy) return -1;
@@ -343,34 +386,41 @@ int web_auth_verify_jwt(struct web_auth_context *ctx, const char *token,
     char *role_str = strstr((char *)payload, "\"role\":\"");
     char *exp_str = strstr((char *)payload, "\"exp\":");
     
-    if (sub && username) {
+    if (sub) {
         sub += 7;
         char *end = strchr(sub, '"');
         if (end) {
             size_t len = end - sub;
-            if (len < username_len) {
+            if (username && len < username_len) {
                 strncpy(username, sub, len);
                 username[len] = '\0';
             }
+            if (len < sizeof(identity.username)) {
+                memcpy(identity.username, sub, len);
+            }
         }
     }
     
-    if (role_str && role) {
+    if (role_str) {
         role_str += 8;
         char *end = strchr(role_str, '"');
         if (end) {
             size_t len = end - role_str;
-            if (len < role_len) {
+            if (role && len < role_len) {
                 strncpy(role, role_str, len);
                 role[len] = '\0';
             }
+            if (len < sizeof(identity.role)) {
+                memcpy(identity.role, role_str, len);
+            }
         }
     }
     
     /* Check expiration */
+    time_t exp = 0;
     if (exp_str) {
         exp_str += 6;
-        time_t exp = atol(exp_str);
+        exp = atol(exp_str);
         if (time(NULL) > exp) {
             free(token_copy);
             return -1;  /* Token expired */
@@ -379,5 +429,7 @@ int web_auth_verify_jwt(struct web_auth_context *ctx, const char *token,
     
     free(token_copy);
     
+    auth_cache_insert(ctx->jwt_cache, token, &identity, exp, generation);
+    
     return 0;
 }
@@ -1,31 +1,119 @@
 #include "web_dashboard.h"
 #include "web_api.h"
+#include "json_buf.h"
+#include "event_cbor.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#define SSE_KEEPALIVE_MS 15000
+#define SSE_KEEPALIVE ": keepalive\n\n"
+
+/* WebSocket subprotocols, clients offering none get JSON */
+static const char *const ws_subprotocols[] = { EVENT_CBOR_SUBPROTOCOL, NULL };
+
+/* Copy the string value of a top level JSON key, unescaped. Returns 0 if
+ * found, 1 if absent and -1 if malformed or too long. */
+static int json_string_field(const char *json, const char *key, char *out, size_t size) {
+    char pattern[64];
+    const char *p;
+    size_t len = 0;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\"", key);
+    p = strstr(json, pattern);
+    if (!p) return 1;
+
+    p += strlen(pattern);
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    if (*p++ != ':') return -1;
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    if (strncmp(p, "null", 4) == 0) return 1;
+    if (*p++ != '"') return -1;
+
+    for (; *p != '"'; p++) {
+        char c = *p;
+
+        if (!c || len + 1 >= size) return -1;
+        if (c == '\\') {
+            switch (*++p) {
+                case '"': case '\\': case '/': c = *p; break;
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case 'u': {
+                    unsigned int code;
+                    if (sscanf(p + 1, "%4x", &code) != 1 || code == 0 || code > 0x7F) return -1;
+                    c = (char)code;
+                    p += 4;
+                    break;
+                }
+                default: return -1;
+            }
+        }
+        out[len++] = c;
+    }
+
+    out[len] = '\0';
+    return 0;
+}
+
+/* Reply to a subscription request */
+static void send_subscription_reply(struct ws_connection *conn, const char *filter,
+                                    const char *error) {
+    struct json_buf reply;
+
+    if (!json_buf_init(&reply, 256)) return;
+
+    if (error) {
+        json_buf_append_str(&reply, "{\"type\":\"error\",\"message\":\"");
+        json_buf_append_escaped(&reply, error, strlen(error));
+    } else {
+        json_buf_append_str(&reply, "{\"type\":\"subscribed\",\"filter\":\"");
+        json_buf_append_escaped(&reply, filter, strlen(filter));
+    }
+    json_buf_append_str(&reply, "\"}");
+
+    if (!reply.failed) websocket_send(conn, reply.data, reply.len);
+    json_buf_free(&reply);
+}
+
 /* WebSocket message handler */
 static void ws_on_message(struct ws_connection *conn, const char *message,
                           size_t len, void *user_data) {
     struct web_dashboard *dashboard = user_data;
-    (void)dashboard; /* Currently unused, reserved for future use */
-
-    printf("WebSocket message received: %.*s\n", (int)len, message);
+    char filter[4096];
+    char error[256];
+    (void)len;
 
-    /* Parse message and handle subscription requests */
+    /* {"type":"subscribe","filter":"<expression>"}, no filter for all events */
     if (strstr(message, "\"type\":\"subscribe\"")) {
-        /* Client subscribed to events */
-        websocket_send(conn, "{\"type\":\"subscribed\"}", 23);
+        int found = json_string_field(message, "filter", filter, sizeof(filter));
+
+        if (found < 0) {
+            send_subscription_reply(conn, NULL, "Malformed filter");
+        } else if (web_stream_subscribe_ws(dashboard->stream, conn,
+                                           found == 0 ? filter : NULL,
+                                           error, sizeof(error)) != 0) {
+            send_subscription_reply(conn, NULL, error);
+        } else {
+            send_subscription_reply(conn, found == 0 ? filter : "", NULL);
+        }
+    } else if (strstr(message, "\"type\":\"unsubscribe\"")) {
+        web_stream_unsubscribe_ws(dashboard->stream, conn);
+        websocket_send(conn, "{\"type\":\"unsubscribed\"}", 23);
     }
 }
 
 /* WebSocket connection handler */
 static void ws_on_connect(struct ws_connection *conn, void *user_data) {
     struct web_dashboard *dashboard = user_data;
-    (void)dashboard; /* Currently unused, reserved for future use */
+    char error[256];
 
     printf("WebSocket client connected\n");
 
+    /* All events until the client subscribes with a filter */
+    web_stream_subscribe_ws(dashboard->stream, conn, NULL, error, sizeof(error));
+
     /* Send welcome message */
     websocket_send(conn, "{\"type\":\"welcome\",\"message\":\"Connected to nlmon\"}", 50);
 }
@@ -33,11 +121,52 @@ static void ws_on_connect(struct ws_connection *conn, void *user_data) {
 /* WebSocket disconnection handler */
 static void ws_on_disconnect(struct ws_connection *conn, void *user_data) {
     struct web_dashboard *dashboard = user_data;
-    (void)dashboard; /* Currently unused, reserved for future use */
+
+    web_stream_unsubscribe_ws(dashboard->stream, conn);
 
     printf("WebSocket client disconnected\n");
 }
 
+/* GET /api/stream?filter=<expression> - Server-Sent Events */
+static void *sse_open(void *user_data, struct web_request *request, int *status, char **error) {
+    struct web_dashboard *dashboard = user_data;
+    char message[256];
+
+    struct web_stream_sse *sse = web_stream_sse_open(dashboard->stream,
+                                                     web_request_arg(request, "filter"),
+                                                     message, sizeof(message));
+    if (!sse) {
+        struct json_buf body;
+
+        *status = 400;
+        if (json_buf_init(&body, 320)) {
+            json_buf_append_str(&body, "{\"error\":\"");
+            json_buf_append_escaped(&body, message, strlen(message));
+            json_buf_append_str(&body, "\"}");
+            *error = body.failed ? NULL : json_buf_detach(&body);
+            json_buf_free(&body);
+        }
+    }
+
+    return sse;
+}
+
+static ssize_t sse_read(void *stream, char *buf, size_t max) {
+    ssize_t n = web_stream_sse_read(stream, buf, max, SSE_KEEPALIVE_MS);
+
+    /* A comment keeps proxies from closing an idle stream */
+    if (n == 0 && max >= sizeof(SSE_KEEPALIVE) - 1) {
+        memcpy(buf, SSE_KEEPALIVE, sizeof(SSE_KEEPALIVE) - 1);
+        n = sizeof(SSE_KEEPALIVE) - 1;
+    }
+
+    return n;
+}
+
+static void sse_close(void *stream) {
+    web_stream_sse_close(stream);
+}
+
 /* Initialize web dashboard */
 struct web_dashboard *web_dashboard_init(struct web_dashboard_config *config,
                                          struct storage_layer *storage,
@@ -49,6 +178,12 @@ struct web_dashboard *web_dashboard_init(struct web_dashboard_config *config,
     if (!dashboard) return NULL;
 
     dashboard->dashboard_config = *config;
+
+    dashboard->stream = web_stream_create();
+    if (!dashboard->stream) {
+        free(dashboard);
+        return NULL;
+    }
     dashboard->storage = storage;
     dashboard->filter_mgr = filter_mgr;
     dashboard->config = nlmon_config;
@@ -58,6 +193,7 @@ struct web_dashboard *web_dashboard_init(struct web_dashboard_config *config,
         dashboard->auth = web_auth_init(config->auth_secret);
         if (!dashboard->auth) {
             fprintf(stderr, "Failed to initialize authentication\n");
+            web_stream_destroy(dashboard->stream);
             free(dashboard);
             return NULL;
         }
@@ -73,13 +209,16 @@ struct web_dashboard *web_dashboard_init(struct web_dashboard_config *config,
         .cert_file = config->cert_file,
         .key_file = config->key_file,
         .static_dir = config->static_dir,
-        .max_connections = 100
+        .max_connections = 100,
+        .thread_pool_size = config->http_threads,
+        .per_ip_limit = config->http_per_ip_limit
     };
 
     dashboard->http_server = web_server_init(&http_config);
     if (!dashboard->http_server) {
         fprintf(stderr, "Failed to initialize HTTP server\n");
         if (dashboard->auth) web_auth_cleanup(dashboard->auth);
+        web_stream_destroy(dashboard->stream);
         free(dashboard);
         return NULL;
     }
@@ -90,7 +229,10 @@ struct web_dashboard *web_dashboard_init(struct web_dashboard_config *config,
         .on_message = ws_on_message,
         .on_connect = ws_on_connect,
         .on_disconnect = ws_on_disconnect,
-        .user_data = dashboard
+        .user_data = dashboard,
+        .cpus = config->ws_cpus,
+        .compression = config->ws_compression,
+        .subprotocols = ws_subprotocols
     };
 
     dashboard->ws_server = websocket_server_init(&ws_config);
@@ -98,19 +240,22 @@ struct web_dashboard *web_dashboard_init(struct web_dashboard_config *config,
         fprintf(stderr, "Failed to initialize WebSocket server\n");
         web_server_cleanup(dashboard->http_server);
         if (dashboard->auth) web_auth_cleanup(dashboard->auth);
+        web_stream_destroy(dashboard->stream);
         free(dashboard);
         return NULL;
     }
 
-    /* Register API endpoints */
-    struct web_api_context api_ctx = {
+    /* Register API endpoints, the routes keep a pointer to the context */
+    dashboard->api = (struct web_api_context){
         .storage = storage,
         .filter_mgr = filter_mgr,
         .config = nlmon_config,
         .alert_mgr = NULL
     };
 
-    web_api_init(dashboard->http_server, &api_ctx);
+    web_api_init(dashboard->http_server, &dashboard->api);
+    web_server_register_stream(dashboard->http_server, "/api/stream", "text/event-stream",
+                               sse_open, sse_read, sse_close, dashboard);
 
     return dashboard;
 }
@@ -151,6 +296,9 @@ int web_dashboard_start(struct web_dashboard *dashboard) {
 void web_dashboard_stop(struct web_dashboard *dashboard) {
     if (!dashboard) return;
 
+    /* Let SSE responses end, the HTTP server waits for them */
+    web_stream_shutdown(dashboard->stream);
+
     if (dashboard->http_server) {
         web_server_stop(dashboard->http_server);
     }
@@ -180,6 +328,7 @@ void web_dashboard_cleanup(struct web_dashboard *dashboard) {
         web_auth_cleanup(dashboard->auth);
     }
 
+    web_stream_destroy(dashboard->stream);
     free(dashboard);
 }
 
@@ -187,8 +336,31 @@ void web_dashboard_cleanup(struct web_dashboard *dashboard) {
 int web_dashboard_broadcast_event(struct web_dashboard *dashboard, const char *event_json) {
     if (!dashboard || !dashboard->ws_server || !event_json) return -1;
 
-    char message[4096];
-    snprintf(message, sizeof(message), "{\"type\":\"event\",\"data\":%s}", event_json);
+    /* Reused across broadcasts, one per calling thread */
+    static __thread struct json_buf message;
+
+    json_buf_reset(&message);
+    json_buf_append_str(&message, "{\"type\":\"event\",\"data\":");
+    json_buf_append_str(&message, event_json);
+    json_buf_append_char(&message, '}');
+    if (message.failed) return -1;
+
+    return websocket_broadcast(dashboard->ws_server, message.data, message.len);
+}
+
+/* Publish event to the WebSocket and SSE clients whose filter matches */
+int web_dashboard_publish_event(struct web_dashboard *dashboard, struct nlmon_event *event,
+                                const char *event_json) {
+    if (!dashboard || !event || !event_json) return -1;
+
+    /* Reused across events, one per calling thread */
+    static __thread struct json_buf message;
+
+    json_buf_reset(&message);
+    json_buf_append_str(&message, "{\"type\":\"event\",\"data\":");
+    json_buf_append_str(&message, event_json);
+    json_buf_append_char(&message, '}');
+    if (message.failed) return -1;
 
-    return websocket_broadcast(dashboard->ws_server, message, strlen(message));
+    return (int)web_stream_publish(dashboard->stream, event, message.data, message.len);
 }
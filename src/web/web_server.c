@@ -6,9 +6,27 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <zlib.h>
+#include "hdr_histogram.h"
 
 #define MAX_ROUTES 64
+#define MAX_STREAMS 8
+#define MAX_RESOURCES 16
 #define MAX_PATH_LEN 256
+#define MAX_SEGMENT_LEN 64
+#define LATENCY_SCHEMA 3
+#define STREAM_BLOCK_SIZE 4096
+#define ETAG_LEN 24
+
+/* Limits of the static files preloaded at start, the rest is read per request */
+#define STATIC_MAX_FILES 512
+#define STATIC_MAX_FILE (8 * 1024 * 1024)
+#define STATIC_MAX_TOTAL (64 * 1024 * 1024)
+#define STATIC_MAX_DEPTH 8
 
 /* Route entry */
 struct route_entry {
@@ -16,6 +34,96 @@ struct route_entry {
     char method[16];
     request_handler_t handler;
     void *user_data;
+    struct hdr_histogram *latency;  /* Microseconds per request */
+    struct route_entry *next;       /* Other methods of the same path */
+};
+
+/* Streaming route entry */
+struct stream_entry {
+    char path[MAX_PATH_LEN];
+    char content_type[64];
+    stream_open_t open_fn;
+    stream_read_t read_fn;
+    stream_close_t close_fn;
+    void *user_data;
+};
+
+/* Cached resource entry, the snapshot is guarded by lock */
+struct resource_entry {
+    char path[MAX_PATH_LEN];
+    char content_type[64];
+    resource_version_t version_fn;
+    resource_build_t build_fn;
+    void *user_data;
+    pthread_mutex_t lock;
+    uint64_t version;
+    char *body;                 /* NULL until first built */
+    size_t len;
+    char etag[ETAG_LEN];
+    struct hdr_histogram *latency;
+};
+
+/* Routing trie node, one per path segment */
+struct route_node {
+    char segment[MAX_SEGMENT_LEN];
+    size_t len;
+    struct route_node *child;       /* First child */
+    struct route_node *sibling;
+    struct route_entry *routes;     /* Routes of exactly this path */
+    struct route_entry *subtree;    /* Routes registered with a trailing '/' */
+    struct stream_entry *stream;
+    struct resource_entry *resource;
+};
+
+/* What a request path resolved to */
+struct route_match {
+    struct route_entry *route;
+    struct stream_entry *stream;
+    struct resource_entry *resource;
+};
+
+/* Counters, updated from every connection thread */
+struct server_counters {
+    _Atomic uint64_t total_requests;
+    _Atomic uint64_t active_connections;
+    _Atomic uint64_t bytes_sent;
+    _Atomic uint64_t bytes_received;
+    _Atomic uint64_t not_modified;
+    _Atomic uint64_t resource_builds;
+    _Atomic uint64_t streams_rejected;
+    _Atomic uint64_t active_streams;
+};
+
+#define STAT_ADD(server, field, n) \
+    atomic_fetch_add_explicit(&(server)->counters.field, (n), memory_order_relaxed)
+#define STAT_SUB(server, field, n) \
+    atomic_fetch_sub_explicit(&(server)->counters.field, (n), memory_order_relaxed)
+#define STAT_GET(server, field) \
+    atomic_load_explicit(&(server)->counters.field, memory_order_relaxed)
+
+/* Static file preloaded at start */
+struct static_file {
+    char path[MAX_PATH_LEN];    /* URL path */
+    const char *mime_type;
+    char *data;
+    size_t len;
+    char *gzip;                 /* NULL when compressing does not pay */
+    size_t gzip_len;
+    char etag[ETAG_LEN];
+    char gzip_etag[ETAG_LEN + 4];
+};
+
+/* Request to a streaming route */
+struct web_request {
+    struct MHD_Connection *connection;
+    const char *content_type;   /* NULL for the route's */
+};
+
+/* Streaming response in progress */
+struct stream_response {
+    struct web_server *server;
+    const struct stream_entry *entry;
+    void *stream;
 };
 
 /* Web server context */
@@ -24,7 +132,17 @@ struct web_server {
     struct web_server_config config;
     struct route_entry routes[MAX_ROUTES];
     int num_routes;
-    struct web_server_stats stats;
+    struct stream_entry streams[MAX_STREAMS];
+    int num_streams;
+    struct resource_entry resources[MAX_RESOURCES];
+    int num_resources;
+    struct static_file *static_files;   /* Sorted by path */
+    size_t num_static;
+    size_t static_capacity;
+    size_t static_bytes;
+    struct route_node root;             /* Routing trie of all of the above */
+    int max_streams;                    /* Concurrent streaming responses, 0 for no limit */
+    struct server_counters counters;
 };
 
 /* Connection info */
@@ -51,6 +169,270 @@ static const char *get_mime_type(const char *path) {
     return "application/octet-stream";
 }
 
+/* Types worth a precompressed variant */
+static int is_compressible(const char *mime_type) {
+    return strncmp(mime_type, "text/", 5) == 0 ||
+           strcmp(mime_type, "application/javascript") == 0 ||
+           strcmp(mime_type, "application/json") == 0 ||
+           strcmp(mime_type, "image/svg+xml") == 0;
+}
+
+/* Strong ETag from an FNV-1a hash of the body */
+static void make_etag(const char *data, size_t len, const char *suffix,
+                      char *etag, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    snprintf(etag, size, "\"%016llx%s\"", (unsigned long long)hash, suffix);
+}
+
+/* If-None-Match lists the ETag, compared weakly as RFC 9110 asks */
+static int etag_matches(struct MHD_Connection *connection, const char *etag) {
+    const char *inm = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "If-None-Match");
+    if (!inm) return 0;
+
+    while (*inm == ' ') inm++;
+    if (*inm == '*') return 1;
+
+    return strstr(inm, etag) != NULL;
+}
+
+/* Accept-Encoding allows gzip, unless with q=0 */
+static int accepts_gzip(struct MHD_Connection *connection) {
+    const char *accept = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Accept-Encoding");
+    const char *p;
+
+    if (!accept || !(p = strstr(accept, "gzip"))) return 0;
+
+    p += 4;
+    while (*p == ' ') p++;
+    if (*p != ';') return 1;
+
+    p = strstr(p, "q=");
+    return !p || strtod(p + 2, NULL) > 0;
+}
+
+/* Answer 304 Not Modified for a cached representation */
+static enum MHD_Result queue_not_modified(struct web_server *server,
+                                          struct MHD_Connection *connection,
+                                          const char *etag, const char *vary) {
+    struct MHD_Response *response;
+    int ret;
+
+    response = MHD_create_response_from_buffer(0, "", MHD_RESPMEM_PERSISTENT);
+    if (!response) return MHD_NO;
+
+    MHD_add_response_header(response, "ETag", etag);
+    MHD_add_response_header(response, "Cache-Control", "no-cache");
+    if (vary) MHD_add_response_header(response, "Vary", vary);
+
+    ret = MHD_queue_response(connection, MHD_HTTP_NOT_MODIFIED, response);
+    MHD_destroy_response(response);
+
+    STAT_ADD(server, not_modified, 1);
+
+    return ret;
+}
+
+/* Gzip a buffer, returns the malloc'd result or NULL */
+static char *gzip_buffer(const char *data, size_t len, size_t *out_len) {
+    z_stream zs;
+    char *out;
+
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return NULL;
+    }
+
+    size_t bound = deflateBound(&zs, len);
+    out = malloc(bound);
+    if (!out) {
+        deflateEnd(&zs);
+        return NULL;
+    }
+
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = len;
+    zs.next_out = (Bytef *)out;
+    zs.avail_out = bound;
+
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+        deflateEnd(&zs);
+        free(out);
+        return NULL;
+    }
+
+    *out_len = zs.total_out;
+    deflateEnd(&zs);
+
+    return out;
+}
+
+/* Load one static file into memory */
+static void preload_file(struct web_server *server, const char *filepath,
+                         const char *url, size_t size) {
+    struct static_file *file;
+    FILE *fp;
+
+    if (server->num_static >= STATIC_MAX_FILES) return;
+    if (size > STATIC_MAX_FILE || server->static_bytes + size > STATIC_MAX_TOTAL) return;
+
+    if (server->num_static == server->static_capacity) {
+        size_t capacity = server->static_capacity ? server->static_capacity * 2 : 32;
+        struct static_file *files = realloc(server->static_files, capacity * sizeof(*files));
+        if (!files) return;
+
+        server->static_files = files;
+        server->static_capacity = capacity;
+    }
+
+    file = &server->static_files[server->num_static];
+    memset(file, 0, sizeof(*file));
+    snprintf(file->path, sizeof(file->path), "%s", url);
+    file->mime_type = get_mime_type(url);
+
+    file->data = malloc(size ? size : 1);
+    if (!file->data) return;
+
+    fp = fopen(filepath, "rb");
+    if (!fp || fread(file->data, 1, size, fp) != size) {
+        if (fp) fclose(fp);
+        free(file->data);
+        return;
+    }
+    fclose(fp);
+    file->len = size;
+    make_etag(file->data, size, "", file->etag, sizeof(file->etag));
+
+    /* Keep the gzip variant only if it saves a tenth or more */
+    if (is_compressible(file->mime_type)) {
+        file->gzip = gzip_buffer(file->data, size, &file->gzip_len);
+        if (file->gzip && file->gzip_len > size - size / 10) {
+            free(file->gzip);
+            file->gzip = NULL;
+        }
+        if (file->gzip) {
+            make_etag(file->data, size, "-gz", file->gzip_etag, sizeof(file->gzip_etag));
+        }
+    }
+
+    server->static_bytes += size;
+    server->num_static++;
+}
+
+/* Load the files of a static directory, hidden entries are skipped */
+static void preload_dir(struct web_server *server, const char *dir,
+                        const char *prefix, int depth) {
+    struct dirent *de;
+    DIR *d;
+
+    d = opendir(dir);
+    if (!d) return;
+
+    while ((de = readdir(d)) != NULL) {
+        char filepath[512];
+        char url[MAX_PATH_LEN];
+        struct stat st;
+
+        if (de->d_name[0] == '.') continue;
+
+        if ((size_t)snprintf(filepath, sizeof(filepath), "%s/%s", dir, de->d_name) >= sizeof(filepath) ||
+            (size_t)snprintf(url, sizeof(url), "%s/%s", prefix, de->d_name) >= sizeof(url)) {
+            continue;
+        }
+
+        if (stat(filepath, &st) < 0) continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            if (depth < STATIC_MAX_DEPTH) preload_dir(server, filepath, url, depth + 1);
+        } else if (S_ISREG(st.st_mode)) {
+            preload_file(server, filepath, url, (size_t)st.st_size);
+        }
+    }
+
+    closedir(d);
+}
+
+static int static_file_cmp(const void *a, const void *b) {
+    return strcmp(((const struct static_file *)a)->path, ((const struct static_file *)b)->path);
+}
+
+static void free_static_files(struct web_server *server) {
+    for (size_t i = 0; i < server->num_static; i++) {
+        free(server->static_files[i].data);
+        free(server->static_files[i].gzip);
+    }
+    free(server->static_files);
+
+    server->static_files = NULL;
+    server->num_static = 0;
+    server->static_capacity = 0;
+    server->static_bytes = 0;
+}
+
+static void preload_static_files(struct web_server *server) {
+    free_static_files(server);
+
+    if (!server->config.static_dir) return;
+
+    preload_dir(server, server->config.static_dir, "", 0);
+    if (server->num_static > 1) {
+        qsort(server->static_files, server->num_static, sizeof(*server->static_files),
+              static_file_cmp);
+    }
+}
+
+static const struct static_file *find_static_file(struct web_server *server, const char *path) {
+    struct static_file key;
+
+    if (server->num_static == 0) return NULL;
+
+    snprintf(key.path, sizeof(key.path), "%s", strcmp(path, "/") == 0 ? "/index.html" : path);
+
+    return bsearch(&key, server->static_files, server->num_static,
+                   sizeof(*server->static_files), static_file_cmp);
+}
+
+/* Serve a preloaded static file, gzipped if the client takes it */
+static enum MHD_Result serve_preloaded(struct web_server *server, const struct static_file *file,
+                                       struct MHD_Connection *connection) {
+    struct MHD_Response *response;
+    int ret;
+
+    int gzip = file->gzip && accepts_gzip(connection);
+    const char *etag = gzip ? file->gzip_etag : file->etag;
+    const char *vary = file->gzip ? "Accept-Encoding" : NULL;
+
+    if (etag_matches(connection, etag)) {
+        return queue_not_modified(server, connection, etag, vary);
+    }
+
+    size_t len = gzip ? file->gzip_len : file->len;
+
+    /* The files stay until web_server_cleanup, after the daemon is stopped */
+    response = MHD_create_response_from_buffer(len, gzip ? file->gzip : file->data,
+                                               MHD_RESPMEM_PERSISTENT);
+    if (!response) return MHD_NO;
+
+    MHD_add_response_header(response, "Content-Type", file->mime_type);
+    MHD_add_response_header(response, "ETag", etag);
+    MHD_add_response_header(response, "Cache-Control", "no-cache");
+    if (vary) MHD_add_response_header(response, "Vary", vary);
+    if (gzip) MHD_add_response_header(response, "Content-Encoding", "gzip");
+
+    ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+
+    STAT_ADD(server, bytes_sent, len);
+
+    return ret;
+}
+
 /* Serve static file */
 static enum MHD_Result serve_static_file(struct web_server *server, const char *path,
                               struct MHD_Connection *connection) {
@@ -60,6 +442,10 @@ static enum MHD_Result serve_static_file(struct web_server *server, const char *
     struct MHD_Response *response;
     int ret;
 
+    /* Preloaded files are answered from memory */
+    const struct static_file *file = find_static_file(server, path);
+    if (file) return serve_preloaded(server, file, connection);
+
     /* Build full file path */
     snprintf(filepath, sizeof(filepath), "%s%s", 
              server->config.static_dir ? server->config.static_dir : ".", path);
@@ -119,23 +505,311 @@ static enum MHD_Result serve_static_file(struct web_server *server, const char *
     ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
     MHD_destroy_response(response);
 
-    server->stats.bytes_sent += st.st_size;
+    STAT_ADD(server, bytes_sent, st.st_size);
 
     return ret;
 }
 
-/* Find matching route */
-static struct route_entry *find_route(struct web_server *server,
-                                      const char *url, const char *method) {
-    for (int i = 0; i < server->num_routes; i++) {
-        if (strcmp(server->routes[i].method, method) == 0 &&
-            strcmp(server->routes[i].path, url) == 0) {
-            return &server->routes[i];
+static uint64_t now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* Find the child of a trie node for one path segment */
+static struct route_node *node_child(struct route_node *node, const char *segment, size_t len) {
+    for (struct route_node *child = node->child; child; child = child->sibling) {
+        if (child->len == len && memcmp(child->segment, segment, len) == 0) {
+            return child;
         }
     }
     return NULL;
 }
 
+/* Find or add the trie node of a registered path, *subtree is set for a
+ * path ending in '/' below the root */
+static struct route_node *node_for_path(struct web_server *server, const char *path,
+                                        int *subtree) {
+    struct route_node *node = &server->root;
+    const char *p = path;
+
+    *subtree = 0;
+    if (*p == '/') p++;
+
+    while (*p) {
+        const char *end = strchr(p, '/');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len >= MAX_SEGMENT_LEN) return NULL;
+
+        struct route_node *child = node_child(node, p, len);
+        if (!child) {
+            child = calloc(1, sizeof(*child));
+            if (!child) return NULL;
+
+            memcpy(child->segment, p, len);
+            child->len = len;
+            child->sibling = node->child;
+            node->child = child;
+        }
+        node = child;
+
+        p += len;
+        if (*p == '/') {
+            p++;
+            if (!*p) *subtree = 1;
+        }
+    }
+
+    return node;
+}
+
+static struct route_entry *route_for_method(struct route_entry *route, const char *method) {
+    for (; route; route = route->next) {
+        if (strcmp(route->method, method) == 0) return route;
+    }
+    return NULL;
+}
+
+/* Resolve a request path, one trie step per segment. A route registered
+ * with a trailing '/' answers every path below it that has no route of
+ * its own, the deepest such route wins. */
+static void route_lookup(struct web_server *server, const char *url, const char *method,
+                         struct route_match *match) {
+    struct route_node *node = &server->root;
+    struct route_entry *below = NULL;
+    int trailing = 0;
+    const char *p = url;
+
+    memset(match, 0, sizeof(*match));
+    if (*p == '/') p++;
+
+    while (*p) {
+        struct route_entry *route = route_for_method(node->subtree, method);
+        if (route) below = route;
+
+        const char *end = strchr(p, '/');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+
+        node = node_child(node, p, len);
+        if (!node) {
+            match->route = below;
+            return;
+        }
+
+        p += len;
+        if (*p == '/') {
+            p++;
+            trailing = !*p;
+        }
+    }
+
+    if (trailing) {
+        struct route_entry *route = route_for_method(node->subtree, method);
+        if (route) below = route;
+    }
+
+    match->stream = node->stream;
+    match->resource = node->resource;
+    match->route = route_for_method(node->routes, method);
+    if (!match->route) match->route = below;
+}
+
+static void free_route_nodes(struct route_node *node) {
+    while (node) {
+        struct route_node *sibling = node->sibling;
+
+        free_route_nodes(node->child);
+        free(node);
+        node = sibling;
+    }
+}
+
+/* Get a query string argument of a request */
+const char *web_request_arg(struct web_request *request, const char *name) {
+    if (!request || !name) return NULL;
+
+    return MHD_lookup_connection_value(request->connection, MHD_GET_ARGUMENT_KIND, name);
+}
+
+/* Get a header of a request */
+const char *web_request_header(struct web_request *request, const char *name) {
+    if (!request || !name) return NULL;
+
+    return MHD_lookup_connection_value(request->connection, MHD_HEADER_KIND, name);
+}
+
+/* Override the content type of a streaming response */
+void web_request_set_content_type(struct web_request *request, const char *content_type) {
+    if (request) request->content_type = content_type;
+}
+
+/* Feed a streaming response. Blocking holds the connection's thread, or
+ * in a thread pool one of its threads, which max_streams accounts for. */
+static ssize_t stream_reader(void *cls, uint64_t pos, char *buf, size_t max) {
+    struct stream_response *res = cls;
+    (void)pos;
+
+    ssize_t n = res->entry->read_fn(res->stream, buf, max);
+
+    return n > 0 ? n : MHD_CONTENT_READER_END_OF_STREAM;
+}
+
+static void stream_free(void *cls) {
+    struct stream_response *res = cls;
+
+    res->entry->close_fn(res->stream);
+    STAT_SUB(res->server, active_streams, 1);
+    free(res);
+}
+
+/* Answer a streaming route */
+static enum MHD_Result serve_stream(struct web_server *server, const struct stream_entry *entry,
+                                    struct MHD_Connection *connection) {
+    struct web_request request = { .connection = connection };
+    struct MHD_Response *response;
+    struct stream_response *res;
+    int status = MHD_HTTP_BAD_REQUEST;
+    char *error = NULL;
+    int ret;
+
+    /* In a thread pool every stream holds a thread until it ends */
+    uint64_t streams = STAT_ADD(server, active_streams, 1);
+    if (server->max_streams > 0 && streams >= (uint64_t)server->max_streams) {
+        STAT_SUB(server, active_streams, 1);
+        STAT_ADD(server, streams_rejected, 1);
+
+        const char *busy = "{\"error\":\"Too many streams\"}";
+        response = MHD_create_response_from_buffer(strlen(busy), (void *)busy,
+                                                   MHD_RESPMEM_PERSISTENT);
+        if (!response) return MHD_NO;
+        MHD_add_response_header(response, "Content-Type", "application/json");
+        MHD_add_response_header(response, "Retry-After", "5");
+        ret = MHD_queue_response(connection, MHD_HTTP_SERVICE_UNAVAILABLE, response);
+        MHD_destroy_response(response);
+        return ret;
+    }
+
+    void *stream = entry->open_fn(entry->user_data, &request, &status, &error);
+    if (!stream) {
+        STAT_SUB(server, active_streams, 1);
+        if (!error) error = strdup("{\"error\":\"Stream not available\"}");
+        if (!error) return MHD_NO;
+
+        size_t len = strlen(error);
+        response = MHD_create_response_from_buffer(len, error, MHD_RESPMEM_MUST_FREE);
+        if (!response) {
+            free(error);
+            return MHD_NO;
+        }
+        MHD_add_response_header(response, "Content-Type", "application/json");
+        ret = MHD_queue_response(connection, status, response);
+        MHD_destroy_response(response);
+        STAT_ADD(server, bytes_sent, len);
+        return ret;
+    }
+
+    res = malloc(sizeof(*res));
+    if (!res) {
+        entry->close_fn(stream);
+        STAT_SUB(server, active_streams, 1);
+        return MHD_NO;
+    }
+    res->server = server;
+    res->entry = entry;
+    res->stream = stream;
+
+    response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, STREAM_BLOCK_SIZE,
+                                                 stream_reader, res, stream_free);
+    if (!response) {
+        stream_free(res);
+        return MHD_NO;
+    }
+
+    MHD_add_response_header(response, "Content-Type",
+                            request.content_type ? request.content_type : entry->content_type);
+    MHD_add_response_header(response, "Cache-Control", "no-cache");
+    MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+
+    ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+
+    return ret;
+}
+
+/* Headers of API responses */
+static void add_api_headers(struct MHD_Response *response, const char *content_type) {
+    MHD_add_response_header(response, "Content-Type", content_type);
+    MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+    MHD_add_response_header(response, "Access-Control-Allow-Methods",
+                            "GET, POST, PUT, DELETE, OPTIONS");
+    MHD_add_response_header(response, "Access-Control-Allow-Headers",
+                            "Content-Type, Authorization");
+}
+
+/* Answer a cached resource, rebuilding its snapshot if it is out of date */
+static enum MHD_Result serve_resource(struct web_server *server, struct resource_entry *res,
+                                      struct MHD_Connection *connection) {
+    struct MHD_Response *response;
+    char etag[ETAG_LEN];
+    int ret;
+
+    uint64_t version = res->version_fn(res->user_data);
+
+    pthread_mutex_lock(&res->lock);
+
+    if (!res->body || res->version != version) {
+        char *body = NULL;
+        size_t len = 0;
+
+        if (res->build_fn(res->user_data, &body, &len) < 0 || !body) {
+            pthread_mutex_unlock(&res->lock);
+            free(body);
+
+            const char *error = "500 Internal Server Error";
+            response = MHD_create_response_from_buffer(strlen(error), (void *)error,
+                                                       MHD_RESPMEM_PERSISTENT);
+            if (!response) return MHD_NO;
+            ret = MHD_queue_response(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, response);
+            MHD_destroy_response(response);
+            return ret;
+        }
+
+        free(res->body);
+        res->body = body;
+        res->len = len;
+        res->version = version;
+        make_etag(body, len, "", res->etag, sizeof(res->etag));
+        STAT_ADD(server, resource_builds, 1);
+    }
+
+    memcpy(etag, res->etag, sizeof(etag));
+
+    if (etag_matches(connection, etag)) {
+        pthread_mutex_unlock(&res->lock);
+        return queue_not_modified(server, connection, etag, NULL);
+    }
+
+    size_t len = res->len;
+    response = MHD_create_response_from_buffer(len, res->body, MHD_RESPMEM_MUST_COPY);
+
+    pthread_mutex_unlock(&res->lock);
+
+    if (!response) return MHD_NO;
+
+    add_api_headers(response, res->content_type);
+    MHD_add_response_header(response, "ETag", etag);
+    MHD_add_response_header(response, "Cache-Control", "no-cache");
+
+    ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+
+    STAT_ADD(server, bytes_sent, len);
+
+    return ret;
+}
+
 /* Request completed callback */
 static void request_completed(void *cls, struct MHD_Connection *connection,
                                void **con_cls, enum MHD_RequestTerminationCode toe) {
@@ -173,8 +847,8 @@ static enum MHD_Result answer_to_connection(void *cls, struct MHD_Connection *co
         con_info->first_call = 1;
         *con_cls = con_info;
 
-        server->stats.total_requests++;
-        server->stats.active_connections++;
+        STAT_ADD(server, total_requests, 1);
+        STAT_ADD(server, active_connections, 1);
 
         return MHD_YES;
     }
@@ -193,7 +867,7 @@ static enum MHD_Result answer_to_connection(void *cls, struct MHD_Connection *co
         con_info->upload_size += *upload_data_size;
         con_info->upload_data[con_info->upload_size] = '\0';
 
-        server->stats.bytes_received += *upload_data_size;
+        STAT_ADD(server, bytes_received, *upload_data_size);
 
         *upload_data_size = 0;
         return MHD_YES;
@@ -204,8 +878,28 @@ static enum MHD_Result answer_to_connection(void *cls, struct MHD_Connection *co
         con_info->first_call = 0;
     }
 
+    struct route_match match;
+    uint64_t start = now_us();
+
+    route_lookup(server, url, method, &match);
+
+    /* Streaming routes answer for as long as the client stays */
+    if (strcmp(method, "GET") == 0) {
+        if (match.stream) {
+            STAT_SUB(server, active_connections, 1);
+            return serve_stream(server, match.stream, connection);
+        }
+
+        if (match.resource) {
+            STAT_SUB(server, active_connections, 1);
+            ret = serve_resource(server, match.resource, connection);
+            hdr_histogram_record(match.resource->latency, (double)(now_us() - start));
+            return ret;
+        }
+    }
+
     /* Try to find matching route */
-    route = find_route(server, url, method);
+    route = match.route;
     if (route) {
         /* Call route handler */
         ret = route->handler(route->user_data, url, method, version,
@@ -228,7 +922,7 @@ static enum MHD_Result answer_to_connection(void *cls, struct MHD_Connection *co
         content_type = "application/json";
     } else {
         /* Try to serve static file */
-        server->stats.active_connections--;
+        STAT_SUB(server, active_connections, 1);
         return serve_static_file(server, url, connection);
     }
 
@@ -242,24 +936,21 @@ static enum MHD_Result answer_to_connection(void *cls, struct MHD_Connection *co
                                                 MHD_RESPMEM_MUST_FREE);
     if (!response) {
         free(response_data);
-        server->stats.active_connections--;
+        STAT_SUB(server, active_connections, 1);
         return MHD_NO;
     }
 
     /* Add headers */
-    MHD_add_response_header(response, "Content-Type", content_type);
-    MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
-    MHD_add_response_header(response, "Access-Control-Allow-Methods",
-                            "GET, POST, PUT, DELETE, OPTIONS");
-    MHD_add_response_header(response, "Access-Control-Allow-Headers",
-                            "Content-Type, Authorization");
+    add_api_headers(response, content_type);
 
     /* Queue response */
     ret = MHD_queue_response(connection, status_code, response);
     MHD_destroy_response(response);
 
-    server->stats.bytes_sent += response_len;
-    server->stats.active_connections--;
+    STAT_ADD(server, bytes_sent, response_len);
+    STAT_SUB(server, active_connections, 1);
+
+    if (route) hdr_histogram_record(route->latency, (double)(now_us() - start));
 
     return ret;
 }
@@ -275,7 +966,6 @@ struct web_server *web_server_init(struct web_server_config *config) {
 
     server->config = *config;
     server->num_routes = 0;
-    memset(&server->stats, 0, sizeof(server->stats));
 
     /* Duplicate string fields */
     if (config->cert_file) {
@@ -288,6 +978,12 @@ struct web_server *web_server_init(struct web_server_config *config) {
         server->config.static_dir = strdup(config->static_dir);
     }
 
+    /* Streams hold a pool thread each, keep half the pool for the rest */
+    server->max_streams = config->max_streams;
+    if (server->max_streams == 0 && config->thread_pool_size > 0) {
+        server->max_streams = config->thread_pool_size > 1 ? config->thread_pool_size / 2 : 1;
+    }
+
     return server;
 }
 
@@ -295,61 +991,163 @@ struct web_server *web_server_init(struct web_server_config *config) {
 int web_server_register_route(struct web_server *server, const char *path,
                                const char *method, request_handler_t handler,
                                void *user_data) {
+    int subtree;
+
     if (!server || !path || !method || !handler) return -1;
     if (server->num_routes >= MAX_ROUTES) return -1;
 
+    struct route_node *node = node_for_path(server, path, &subtree);
+    if (!node) return -1;
+
     struct route_entry *route = &server->routes[server->num_routes];
 
+    route->latency = hdr_histogram_create(LATENCY_SCHEMA);
+    if (!route->latency) return -1;
+
     snprintf(route->path, sizeof(route->path), "%s", path);
     snprintf(route->method, sizeof(route->method), "%s", method);
     route->handler = handler;
     route->user_data = user_data;
 
+    /* Appended, so the first registration of a path and method wins */
+    struct route_entry **tail = subtree ? &node->subtree : &node->routes;
+    while (*tail) tail = &(*tail)->next;
+    *tail = route;
+
     server->num_routes++;
 
     return 0;
 }
 
+/* Register streaming route */
+int web_server_register_stream(struct web_server *server, const char *path,
+                               const char *content_type, stream_open_t open_fn,
+                               stream_read_t read_fn, stream_close_t close_fn,
+                               void *user_data) {
+    int subtree;
+
+    if (!server || !path || !content_type || !open_fn || !read_fn || !close_fn) return -1;
+    if (server->num_streams >= MAX_STREAMS) return -1;
+
+    struct route_node *node = node_for_path(server, path, &subtree);
+    if (!node || node->stream) return -1;
+
+    struct stream_entry *entry = &server->streams[server->num_streams];
+
+    snprintf(entry->path, sizeof(entry->path), "%s", path);
+    snprintf(entry->content_type, sizeof(entry->content_type), "%s", content_type);
+    entry->open_fn = open_fn;
+    entry->read_fn = read_fn;
+    entry->close_fn = close_fn;
+    entry->user_data = user_data;
+    node->stream = entry;
+
+    server->num_streams++;
+
+    return 0;
+}
+
+/* Register cached resource */
+int web_server_register_resource(struct web_server *server, const char *path,
+                                 const char *content_type, resource_version_t version_fn,
+                                 resource_build_t build_fn, void *user_data) {
+    int subtree;
+
+    if (!server || !path || !content_type || !version_fn || !build_fn) return -1;
+    if (server->num_resources >= MAX_RESOURCES) return -1;
+
+    struct route_node *node = node_for_path(server, path, &subtree);
+    if (!node || node->resource) return -1;
+
+    struct resource_entry *res = &server->resources[server->num_resources];
+
+    memset(res, 0, sizeof(*res));
+    res->latency = hdr_histogram_create(LATENCY_SCHEMA);
+    if (!res->latency) return -1;
+    if (pthread_mutex_init(&res->lock, NULL) != 0) {
+        hdr_histogram_destroy(res->latency);
+        return -1;
+    }
+
+    snprintf(res->path, sizeof(res->path), "%s", path);
+    snprintf(res->content_type, sizeof(res->content_type), "%s", content_type);
+    res->version_fn = version_fn;
+    res->build_fn = build_fn;
+    res->user_data = user_data;
+    node->resource = res;
+
+    server->num_resources++;
+
+    return 0;
+}
+
 /* Start web server */
 int web_server_start(struct web_server *server) {
-    unsigned int flags = MHD_USE_THREAD_PER_CONNECTION;
+    struct web_server_config *config;
+    struct MHD_OptionItem options[8];
+    unsigned int flags;
+    int n = 0;
 
     if (!server) return -1;
+    config = &server->config;
+
+    /* A thread per connection, or a pool of epoll loops */
+    flags = config->thread_pool_size > 0 ? MHD_USE_EPOLL_INTERNAL_THREAD
+                                         : MHD_USE_THREAD_PER_CONNECTION;
+
+    preload_static_files(server);
+    if (server->num_static > 0) {
+        printf("Web server preloaded %zu static files (%zu bytes)\n",
+               server->num_static, server->static_bytes);
+    }
 
     /* Add TLS support if enabled */
     if (server->config.enable_tls) {
         flags |= MHD_USE_TLS;
     }
 
-    /* Start daemon */
-    if (server->config.enable_tls && server->config.cert_file && server->config.key_file) {
-        server->daemon = MHD_start_daemon(flags, server->config.port,
-                                          NULL, NULL,
-                                          &answer_to_connection, server,
-                                          MHD_OPTION_NOTIFY_COMPLETED, request_completed, NULL,
-                                          MHD_OPTION_CONNECTION_LIMIT,
-                                          server->config.max_connections > 0 ?
-                                          server->config.max_connections : 100,
-                                          MHD_OPTION_HTTPS_MEM_CERT, server->config.cert_file,
-                                          MHD_OPTION_HTTPS_MEM_KEY, server->config.key_file,
-                                          MHD_OPTION_END);
-    } else {
-        server->daemon = MHD_start_daemon(flags, server->config.port,
-                                          NULL, NULL,
-                                          &answer_to_connection, server,
-                                          MHD_OPTION_NOTIFY_COMPLETED, request_completed, NULL,
-                                          MHD_OPTION_CONNECTION_LIMIT,
-                                          server->config.max_connections > 0 ?
-                                          server->config.max_connections : 100,
-                                          MHD_OPTION_END);
+    /* Options */
+    options[n++] = (struct MHD_OptionItem){ MHD_OPTION_NOTIFY_COMPLETED,
+                                            (intptr_t)request_completed, NULL };
+    options[n++] = (struct MHD_OptionItem){ MHD_OPTION_CONNECTION_LIMIT,
+                                            config->max_connections > 0 ?
+                                            config->max_connections : 100, NULL };
+    if (config->thread_pool_size > 0) {
+        options[n++] = (struct MHD_OptionItem){ MHD_OPTION_THREAD_POOL_SIZE,
+                                                config->thread_pool_size, NULL };
+    }
+    if (config->per_ip_limit > 0) {
+        options[n++] = (struct MHD_OptionItem){ MHD_OPTION_PER_IP_CONNECTION_LIMIT,
+                                                config->per_ip_limit, NULL };
+    }
+    if (config->connection_timeout > 0) {
+        options[n++] = (struct MHD_OptionItem){ MHD_OPTION_CONNECTION_TIMEOUT,
+                                                config->connection_timeout, NULL };
     }
+    if (config->enable_tls && config->cert_file && config->key_file) {
+        options[n++] = (struct MHD_OptionItem){ MHD_OPTION_HTTPS_MEM_CERT, 0, config->cert_file };
+        options[n++] = (struct MHD_OptionItem){ MHD_OPTION_HTTPS_MEM_KEY, 0, config->key_file };
+    }
+    options[n] = (struct MHD_OptionItem){ MHD_OPTION_END, 0, NULL };
+
+    /* Start daemon */
+    server->daemon = MHD_start_daemon(flags, config->port,
+                                      NULL, NULL,
+                                      &answer_to_connection, server,
+                                      MHD_OPTION_ARRAY, options,
+                                      MHD_OPTION_END);
 
     if (!server->daemon) {
         fprintf(stderr, "Failed to start web server on port %d\n", server->config.port);
         return -1;
     }
 
-    printf("Web server started on port %d\n", server->config.port);
+    if (config->thread_pool_size > 0) {
+        printf("Web server started on port %d with %d threads\n",
+               config->port, config->thread_pool_size);
+    } else {
+        printf("Web server started on port %d\n", config->port);
+    }
 
     return 0;
 }
@@ -374,6 +1172,17 @@ void web_server_cleanup(struct web_server *server) {
     if (server->config.key_file) free(server->config.key_file);
     if (server->config.static_dir) free(server->config.static_dir);
 
+    for (int i = 0; i < server->num_routes; i++) {
+        hdr_histogram_destroy(server->routes[i].latency);
+    }
+    for (int i = 0; i < server->num_resources; i++) {
+        pthread_mutex_destroy(&server->resources[i].lock);
+        free(server->resources[i].body);
+        hdr_histogram_destroy(server->resources[i].latency);
+    }
+    free_route_nodes(server->root.child);
+    free_static_files(server);
+
     free(server);
 }
 
@@ -381,7 +1190,54 @@ void web_server_cleanup(struct web_server *server) {
 int web_server_get_stats(struct web_server *server, struct web_server_stats *stats) {
     if (!server || !stats) return -1;
 
-    *stats = server->stats;
+    stats->total_requests = STAT_GET(server, total_requests);
+    stats->active_connections = STAT_GET(server, active_connections);
+    stats->bytes_sent = STAT_GET(server, bytes_sent);
+    stats->bytes_received = STAT_GET(server, bytes_received);
+    stats->not_modified = STAT_GET(server, not_modified);
+    stats->resource_builds = STAT_GET(server, resource_builds);
+    stats->streams_rejected = STAT_GET(server, streams_rejected);
+    stats->active_streams = STAT_GET(server, active_streams);
 
     return 0;
 }
+
+static void fill_route_stats(struct web_route_stats *stats, const char *path,
+                             const char *method, const struct hdr_histogram *latency) {
+    snprintf(stats->path, sizeof(stats->path), "%s", path);
+    snprintf(stats->method, sizeof(stats->method), "%s", method);
+    stats->requests = hdr_histogram_count(latency);
+    if (stats->requests == 0) {
+        stats->mean_us = stats->p50_us = stats->p90_us = stats->p99_us = stats->max_us = 0;
+        return;
+    }
+
+    stats->mean_us = hdr_histogram_sum(latency) / stats->requests;
+    stats->p50_us = hdr_histogram_quantile(latency, 0.5);
+    stats->p90_us = hdr_histogram_quantile(latency, 0.9);
+    stats->p99_us = hdr_histogram_quantile(latency, 0.99);
+    stats->max_us = hdr_histogram_max(latency);
+}
+
+/* Get per-route latency statistics */
+size_t web_server_get_route_stats(struct web_server *server, struct web_route_stats *stats,
+                                  size_t max) {
+    size_t n = 0;
+
+    if (!server) return 0;
+
+    for (int i = 0; i < server->num_routes; i++, n++) {
+        if (stats && n < max) {
+            fill_route_stats(&stats[n], server->routes[i].path, server->routes[i].method,
+                             server->routes[i].latency);
+        }
+    }
+    for (int i = 0; i < server->num_resources; i++, n++) {
+        if (stats && n < max) {
+            fill_route_stats(&stats[n], server->resources[i].path, "GET",
+                             server->resources[i].latency);
+        }
+    }
+
+    return n;
+}
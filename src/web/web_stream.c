@@ -0,0 +1,601 @@
+#include "web_stream.h"
+#include "websocket_server.h"
+#include "event_cbor.h"
+#include "filter_parser.h"
+#include "filter_compiler.h"
+#include "filter_cache.h"
+#include "filter_eval.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#define MAX_EXPRESSION 4096         /* Longest filter expression */
+#define SSE_QUEUE_BYTES (256 * 1024) /* Queued bytes per SSE subscriber */
+#define SSE_PREFIX "data: "
+#define SSE_SUFFIX "\n\n"
+
+/* Subscribers sharing one filter */
+struct stream_group {
+    char *key;                      /* Normalized expression, "" for all events */
+    struct filter_bytecode *filter; /* NULL for all events */
+    struct ws_connection **ws;
+    size_t ws_count;
+    size_t ws_cap;
+    struct web_stream_sse **sse;
+    size_t sse_count;
+    size_t sse_cap;
+};
+
+/* Filtered stream hub */
+struct web_stream {
+    pthread_mutex_t lock;           /* Groups, members and statistics */
+    struct stream_group **groups;
+    size_t group_count;
+    size_t group_cap;
+
+    /* WebSocket connections matching the event being published */
+    struct ws_connection **targets;
+    size_t target_cap;
+    struct ws_connection **binary_targets;
+    size_t binary_cap;
+
+    /* Names known to all CBOR subscribers, and the buffers of an event */
+    struct event_cbor_dict *dict;
+    struct json_buf cbor;
+    struct json_buf cbor_defs;
+
+    uint64_t events;
+    uint64_t filter_evals;
+    uint64_t deliveries;
+    uint64_t sse_dropped;
+};
+
+/* Server-Sent Events subscriber */
+struct web_stream_sse {
+    struct web_stream *stream;
+    struct stream_group *group;     /* Protected by the stream lock */
+
+    /* Ring of formatted events */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char *buf;
+    size_t head;
+    size_t len;
+    bool closed;
+};
+
+/* Grow an array of pointers to hold one more */
+static bool reserve(void *array, size_t count, size_t *cap) {
+    void ***items = array;
+
+    if (count < *cap) return true;
+
+    size_t new_cap = *cap ? *cap * 2 : 4;
+    void **grown = realloc(*items, new_cap * sizeof(**items));
+    if (!grown) return false;
+
+    *items = grown;
+    *cap = new_cap;
+    return true;
+}
+
+/* Collapse whitespace outside string literals, so that expressions that
+ * differ only in spacing land in one group */
+static int normalize_expression(const char *expression, char *out, size_t size) {
+    size_t len = 0;
+    char quote = 0;
+    bool space = false;
+
+    for (const char *p = expression; *p; p++) {
+        char c = *p;
+
+        if (!quote && (c == ' ' || c == '\t' || c == '\r' || c == '\n')) {
+            space = len > 0;
+            continue;
+        }
+
+        if (space) {
+            if (len + 1 >= size) return -1;
+            out[len++] = ' ';
+            space = false;
+        }
+
+        if (quote) {
+            if (c == '\\' && p[1]) {
+                if (len + 1 >= size) return -1;
+                out[len++] = c;
+                c = *++p;
+            } else if (c == quote) {
+                quote = 0;
+            }
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+        }
+
+        if (len + 1 >= size) return -1;
+        out[len++] = c;
+    }
+
+    out[len] = '\0';
+    return 0;
+}
+
+static void group_free(struct stream_group *group) {
+    filter_bytecode_free(group->filter);
+    free(group->ws);
+    free(group->sse);
+    free(group->key);
+    free(group);
+}
+
+/* Drop a group without members, stream lock held */
+static void group_release(struct web_stream *stream, struct stream_group *group) {
+    if (group->ws_count || group->sse_count) return;
+
+    for (size_t i = 0; i < stream->group_count; i++) {
+        if (stream->groups[i] == group) {
+            stream->groups[i] = stream->groups[--stream->group_count];
+            break;
+        }
+    }
+    group_free(group);
+}
+
+/* Find or create the group of an expression, stream lock held */
+static struct stream_group *group_get(struct web_stream *stream, const char *expression,
+                                      char *error, size_t error_len) {
+    char key[MAX_EXPRESSION];
+
+    if (normalize_expression(expression ? expression : "", key, sizeof(key)) != 0) {
+        snprintf(error, error_len, "Filter longer than %d bytes", MAX_EXPRESSION - 1);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < stream->group_count; i++) {
+        if (strcmp(stream->groups[i]->key, key) == 0) return stream->groups[i];
+    }
+
+    if (!reserve(&stream->groups, stream->group_count, &stream->group_cap)) goto err_nomem;
+
+    struct stream_group *group = calloc(1, sizeof(*group));
+    if (!group) goto err_nomem;
+
+    group->key = strdup(key);
+    if (!group->key) {
+        free(group);
+        goto err_nomem;
+    }
+
+    /* Compiled once for all its subscribers, shared with equal filters elsewhere */
+    if (key[0]) {
+        struct filter_parse_error parse_error = { .message = "" };
+
+        group->filter = filter_cache_get(key, &parse_error);
+        if (!group->filter) {
+            if (parse_error.message[0]) {
+                snprintf(error, error_len, "%s at column %zu",
+                         parse_error.message, parse_error.column);
+            } else {
+                snprintf(error, error_len, "Filter could not be compiled");
+            }
+            group_free(group);
+            return NULL;
+        }
+    }
+
+    stream->groups[stream->group_count++] = group;
+    return group;
+
+err_nomem:
+    snprintf(error, error_len, "Out of memory");
+    return NULL;
+}
+
+static bool is_binary(struct ws_connection *conn) {
+    const char *subprotocol = websocket_get_subprotocol(conn);
+
+    return subprotocol && strcmp(subprotocol, EVENT_CBOR_SUBPROTOCOL) == 0;
+}
+
+/* Remove a WebSocket connection from its group, stream lock held */
+static void ws_remove(struct web_stream *stream, struct ws_connection *conn) {
+    for (size_t i = 0; i < stream->group_count; i++) {
+        struct stream_group *group = stream->groups[i];
+
+        for (size_t j = 0; j < group->ws_count; j++) {
+            if (group->ws[j] == conn) {
+                group->ws[j] = group->ws[--group->ws_count];
+                group_release(stream, group);
+                return;
+            }
+        }
+    }
+}
+
+/* Create stream hub */
+struct web_stream *web_stream_create(void) {
+    struct web_stream *stream = calloc(1, sizeof(*stream));
+    if (!stream) return NULL;
+
+    stream->dict = event_cbor_dict_create();
+    if (!stream->dict || !json_buf_init(&stream->cbor, 256) ||
+        !json_buf_init(&stream->cbor_defs, 256)) {
+        json_buf_free(&stream->cbor);
+        event_cbor_dict_destroy(stream->dict);
+        free(stream);
+        return NULL;
+    }
+
+    pthread_mutex_init(&stream->lock, NULL);
+
+    return stream;
+}
+
+/* Destroy stream hub */
+void web_stream_destroy(struct web_stream *stream) {
+    if (!stream) return;
+
+    /* SSE subscribers left open are detached, their close frees them */
+    for (size_t i = 0; i < stream->group_count; i++) {
+        struct stream_group *group = stream->groups[i];
+
+        for (size_t j = 0; j < group->sse_count; j++) {
+            group->sse[j]->group = NULL;
+            group->sse[j]->stream = NULL;
+        }
+        group_free(group);
+    }
+
+    pthread_mutex_destroy(&stream->lock);
+    free(stream->groups);
+    free(stream->targets);
+    free(stream->binary_targets);
+    event_cbor_dict_destroy(stream->dict);
+    json_buf_free(&stream->cbor);
+    json_buf_free(&stream->cbor_defs);
+    free(stream);
+}
+
+/* Subscribe a WebSocket connection */
+int web_stream_subscribe_ws(struct web_stream *stream, struct ws_connection *conn,
+                            const char *expression, char *error, size_t error_len) {
+    if (!stream || !conn) return -1;
+
+    pthread_mutex_lock(&stream->lock);
+
+    struct stream_group *group = group_get(stream, expression, error, error_len);
+    if (!group) {
+        pthread_mutex_unlock(&stream->lock);
+        return -1;
+    }
+
+    /* Resubscribing to the group it is in */
+    for (size_t i = 0; i < group->ws_count; i++) {
+        if (group->ws[i] == conn) {
+            pthread_mutex_unlock(&stream->lock);
+            return 0;
+        }
+    }
+
+    if (!reserve(&group->ws, group->ws_count, &group->ws_cap)) {
+        group_release(stream, group);
+        pthread_mutex_unlock(&stream->lock);
+        snprintf(error, error_len, "Out of memory");
+        return -1;
+    }
+
+    /* A CBOR client learns the names in use before its first event */
+    if (is_binary(conn)) {
+        bool member = false;
+
+        for (size_t i = 0; i < stream->group_count && !member; i++) {
+            for (size_t j = 0; j < stream->groups[i]->ws_count; j++) {
+                if (stream->groups[i]->ws[j] == conn) member = true;
+            }
+        }
+        if (!member) {
+            json_buf_reset(&stream->cbor_defs);
+            event_cbor_append_dict(&stream->cbor_defs, stream->dict);
+            if (stream->cbor_defs.len) {
+                websocket_send_binary(conn, stream->cbor_defs.data, stream->cbor_defs.len);
+            }
+        }
+    }
+
+    /* Join the new group before leaving the old one, it may be the same filter */
+    group->ws[group->ws_count++] = conn;
+    for (size_t i = 0; i < stream->group_count; i++) {
+        struct stream_group *old = stream->groups[i];
+
+        if (old == group) continue;
+        for (size_t j = 0; j < old->ws_count; j++) {
+            if (old->ws[j] == conn) {
+                old->ws[j] = old->ws[--old->ws_count];
+                group_release(stream, old);
+                goto done;
+            }
+        }
+    }
+
+done:
+    pthread_mutex_unlock(&stream->lock);
+    return 0;
+}
+
+/* Unsubscribe a WebSocket connection */
+void web_stream_unsubscribe_ws(struct web_stream *stream, struct ws_connection *conn) {
+    if (!stream || !conn) return;
+
+    pthread_mutex_lock(&stream->lock);
+    ws_remove(stream, conn);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+/* Open an SSE subscriber */
+struct web_stream_sse *web_stream_sse_open(struct web_stream *stream, const char *expression,
+                                           char *error, size_t error_len) {
+    pthread_condattr_t attr;
+
+    if (!stream) return NULL;
+
+    struct web_stream_sse *sse = calloc(1, sizeof(*sse));
+    if (!sse) goto err_nomem;
+
+    sse->buf = malloc(SSE_QUEUE_BYTES);
+    if (!sse->buf) {
+        free(sse);
+        goto err_nomem;
+    }
+
+    sse->stream = stream;
+    pthread_mutex_init(&sse->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sse->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_mutex_lock(&stream->lock);
+
+    struct stream_group *group = group_get(stream, expression, error, error_len);
+    if (group && !reserve(&group->sse, group->sse_count, &group->sse_cap)) {
+        group_release(stream, group);
+        snprintf(error, error_len, "Out of memory");
+        group = NULL;
+    }
+    if (group) {
+        group->sse[group->sse_count++] = sse;
+        sse->group = group;
+    }
+
+    pthread_mutex_unlock(&stream->lock);
+
+    if (!group) {
+        sse->stream = NULL;
+        web_stream_sse_close(sse);
+        return NULL;
+    }
+
+    return sse;
+
+err_nomem:
+    snprintf(error, error_len, "Out of memory");
+    return NULL;
+}
+
+/* Append a formatted event, dropped if it does not fit. Stream lock held. */
+static bool sse_push(struct web_stream_sse *sse, const char *message, size_t len) {
+    const char *parts[3] = { SSE_PREFIX, message, SSE_SUFFIX };
+    size_t sizes[3] = { sizeof(SSE_PREFIX) - 1, len, sizeof(SSE_SUFFIX) - 1 };
+    bool queued = false;
+
+    pthread_mutex_lock(&sse->lock);
+
+    if (!sse->closed && SSE_QUEUE_BYTES - sse->len >= sizes[0] + sizes[1] + sizes[2]) {
+        for (int i = 0; i < 3; i++) {
+            size_t tail = (sse->head + sse->len) % SSE_QUEUE_BYTES;
+            size_t first = SSE_QUEUE_BYTES - tail;
+
+            if (first > sizes[i]) first = sizes[i];
+            memcpy(sse->buf + tail, parts[i], first);
+            memcpy(sse->buf, parts[i] + first, sizes[i] - first);
+            sse->len += sizes[i];
+        }
+        pthread_cond_signal(&sse->cond);
+        queued = true;
+    }
+
+    pthread_mutex_unlock(&sse->lock);
+
+    return queued;
+}
+
+/* Read queued events of an SSE subscriber */
+ssize_t web_stream_sse_read(struct web_stream_sse *sse, char *buf, size_t size,
+                            int timeout_ms) {
+    struct timespec deadline;
+    ssize_t n = 0;
+
+    if (!sse || !buf || !size) return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&sse->lock);
+
+    while (!sse->len && !sse->closed) {
+        if (pthread_cond_timedwait(&sse->cond, &sse->lock, &deadline) == ETIMEDOUT) break;
+    }
+
+    if (sse->len) {
+        size_t first = SSE_QUEUE_BYTES - sse->head;
+
+        n = sse->len < size ? sse->len : size;
+        if (first > (size_t)n) first = n;
+        memcpy(buf, sse->buf + sse->head, first);
+        memcpy(buf + first, sse->buf, n - first);
+        sse->head = (sse->head + n) % SSE_QUEUE_BYTES;
+        sse->len -= n;
+    } else if (sse->closed) {
+        n = -1;
+    }
+
+    pthread_mutex_unlock(&sse->lock);
+
+    return n;
+}
+
+/* Unsubscribe and free an SSE subscriber */
+void web_stream_sse_close(struct web_stream_sse *sse) {
+    if (!sse) return;
+
+    struct web_stream *stream = sse->stream;
+
+    if (stream) {
+        pthread_mutex_lock(&stream->lock);
+        struct stream_group *group = sse->group;
+        for (size_t i = 0; group && i < group->sse_count; i++) {
+            if (group->sse[i] == sse) {
+                group->sse[i] = group->sse[--group->sse_count];
+                group_release(stream, group);
+                break;
+            }
+        }
+        pthread_mutex_unlock(&stream->lock);
+    }
+
+    pthread_cond_destroy(&sse->cond);
+    pthread_mutex_destroy(&sse->lock);
+    free(sse->buf);
+    free(sse);
+}
+
+/* Send new name definitions to every CBOR subscriber, matching or not,
+ * so the dictionary stays the same for all. Stream lock held. */
+static void send_definitions(struct web_stream *stream) {
+    for (size_t i = 0; i < stream->group_count; i++) {
+        struct stream_group *group = stream->groups[i];
+
+        for (size_t j = 0; j < group->ws_count; j++) {
+            if (is_binary(group->ws[j])) {
+                websocket_send_binary(group->ws[j], stream->cbor_defs.data,
+                                      stream->cbor_defs.len);
+            }
+        }
+    }
+}
+
+/* Publish an event to the matching subscribers */
+size_t web_stream_publish(struct web_stream *stream, struct nlmon_event *event,
+                          const char *message, size_t len) {
+    size_t targets = 0;
+    size_t binary = 0;
+    size_t delivered = 0;
+
+    if (!stream || !event || !message) return 0;
+
+    pthread_mutex_lock(&stream->lock);
+
+    stream->events++;
+
+    for (size_t i = 0; i < stream->group_count; i++) {
+        struct stream_group *group = stream->groups[i];
+
+        /* Once per distinct filter, however many subscribe to it */
+        if (group->filter) {
+            stream->filter_evals++;
+            if (!filter_eval(group->filter, event, NULL)) continue;
+        }
+
+        for (size_t j = 0; j < group->ws_count; j++) {
+            struct ws_connection *conn = group->ws[j];
+
+            if (is_binary(conn)) {
+                if (reserve(&stream->binary_targets, binary, &stream->binary_cap)) {
+                    stream->binary_targets[binary++] = conn;
+                }
+            } else if (reserve(&stream->targets, targets, &stream->target_cap)) {
+                stream->targets[targets++] = conn;
+            }
+        }
+
+        for (size_t j = 0; j < group->sse_count; j++) {
+            if (sse_push(group->sse[j], message, len)) delivered++;
+            else stream->sse_dropped++;
+        }
+    }
+
+    /* One frame for every matching WebSocket client */
+    if (targets && websocket_multicast(stream->targets, targets, message, len) == 0) {
+        delivered += targets;
+    }
+
+    /* And one for the CBOR ones, encoded only if there are any */
+    if (binary) {
+        struct event_cbor_record record;
+
+        json_buf_reset(&stream->cbor);
+        json_buf_reset(&stream->cbor_defs);
+        event_cbor_record_init(&record, event);
+        event_cbor_append(&stream->cbor, &stream->cbor_defs, stream->dict, &record);
+
+        if (stream->cbor_defs.len) send_definitions(stream);
+        if (stream->cbor.len && websocket_multicast_binary(stream->binary_targets, binary,
+                                                           stream->cbor.data,
+                                                           stream->cbor.len) == 0) {
+            delivered += binary;
+        }
+    }
+
+    stream->deliveries += delivered;
+
+    pthread_mutex_unlock(&stream->lock);
+
+    return delivered;
+}
+
+/* End all SSE reads */
+void web_stream_shutdown(struct web_stream *stream) {
+    if (!stream) return;
+
+    pthread_mutex_lock(&stream->lock);
+    for (size_t i = 0; i < stream->group_count; i++) {
+        struct stream_group *group = stream->groups[i];
+
+        for (size_t j = 0; j < group->sse_count; j++) {
+            struct web_stream_sse *sse = group->sse[j];
+
+            pthread_mutex_lock(&sse->lock);
+            sse->closed = true;
+            pthread_cond_broadcast(&sse->cond);
+            pthread_mutex_unlock(&sse->lock);
+        }
+    }
+    pthread_mutex_unlock(&stream->lock);
+}
+
+/* Get stream statistics */
+void web_stream_get_stats(struct web_stream *stream, struct web_stream_stats *stats) {
+    if (!stream || !stats) return;
+
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&stream->lock);
+    stats->groups = stream->group_count;
+    for (size_t i = 0; i < stream->group_count; i++) {
+        stats->subscribers += stream->groups[i]->ws_count + stream->groups[i]->sse_count;
+    }
+    stats->events = stream->events;
+    stats->filter_evals = stream->filter_evals;
+    stats->deliveries = stream->deliveries;
+    stats->sse_dropped = stream->sse_dropped;
+    pthread_mutex_unlock(&stream->lock);
+}
@@ -1,21 +1,45 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "websocket_server.h"
+#include "thread_affinity.h"
+#include "pipeline_watchdog.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <openssl/sha.h>
-#include <openssl/bio.h>
 #include <openssl/evp.h>
-#include <openssl/buffer.h>
+#include <zlib.h>
 
-#define MAX_CONNECTIONS 100
-#define BUFFER_SIZE 8192
+#define MAX_CONNECTIONS 16384       /* Clients across all loops */
+#define MAX_EVENTS 256              /* epoll events handled per wakeup */
+#define ACCEPT_BATCH 32             /* Connections accepted per wakeup */
+#define HANDSHAKE_MAX 8192          /* Longest upgrade request */
+#define RECV_CHUNK 4096             /* Initial receive buffer */
+#define MAX_MESSAGE (1024 * 1024)   /* Largest client message, reassembled */
+#define MAX_QUEUED (4 * 1024 * 1024) /* Unsent bytes queued per client */
+#define QUEUE_FRAMES 128            /* Frames queued per client */
+#define MAX_IOV 16                  /* Queued frames written per sendmsg */
 #define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
 
+/* permessage-deflate */
+#define DEFLATE_MIN 64              /* Shorter messages are sent as they are */
+#define DEFLATE_LEVEL 6
+#define DEFLATE_MEM_LEVEL 8
+#define WS_RSV1 0x40                /* Compressed message bit */
+
 /* WebSocket opcodes */
 #define WS_OPCODE_CONTINUATION 0x0
 #define WS_OPCODE_TEXT 0x1
@@ -24,74 +48,288 @@
 #define WS_OPCODE_PING 0x9
 #define WS_OPCODE_PONG 0xA
 
-/* WebSocket connection */
+/* Close status codes */
+#define WS_CLOSE_PROTOCOL_ERROR 1002
+#define WS_CLOSE_INVALID_DATA 1007
+#define WS_CLOSE_TOO_BIG 1009
+
+/* Connection states */
+enum ws_state {
+    WS_STATE_HANDSHAKE,         /* Waiting for the upgrade request */
+    WS_STATE_OPEN,              /* Exchanging messages */
+    WS_STATE_CLOSING            /* Close frame queued, no more messages */
+};
+
+/* Encoded frame or handshake response, shared by every connection it is
+ * queued on */
+struct ws_frame {
+    atomic_uint refs;
+    bool skippable;             /* A broadcast a lagging client may miss */
+    bool compressible;          /* An uncompressed text or binary message */
+    int opcode;
+    size_t header_len;
+    size_t len;
+
+    /* Compressed once for the clients without context takeover, protected
+     * by the server deflate lock */
+    bool deflate_tried;
+    struct ws_frame *deflated;  /* NULL if compression did not pay off */
+
+    unsigned char data[];
+};
+
+/* permessage-deflate parameters agreed with a client */
+struct ws_extension {
+    bool deflate;
+    bool server_no_context;     /* server_no_context_takeover */
+    bool client_no_context;     /* client_no_context_takeover */
+    int server_window_bits;     /* server_max_window_bits, 0 if not given */
+};
+
+/* permessage-deflate state of a connection */
+struct ws_deflate {
+    bool shared;                /* Gets the frames compressed by the server */
+    bool no_context;            /* Reset the compressor for every message */
+    int window_bits;
+
+    /* Own compressor, set up on first use */
+    z_stream out;
+    bool out_ready;
+
+    /* Decompressor of client messages, set up on first use */
+    z_stream in;
+    bool in_ready;
+    unsigned char *in_buf;
+    size_t in_cap;
+
+    /* Statistics, protected by the loop lock */
+    uint64_t messages;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+};
+
+struct ws_loop;
+
+/* WebSocket connection, owned by the loop that accepted it */
 struct ws_connection {
     int fd;
-    int active;
-    pthread_t thread;
+    enum ws_state state;
+    struct ws_loop *loop;
     struct websocket_server *server;
     void *user_data;
-    char recv_buffer[BUFFER_SIZE];
+    struct ws_connection *prev;
+    struct ws_connection *next;
+
+    /* Received bytes not yet parsed, one spare byte for a NUL */
+    unsigned char *recv_buf;
     size_t recv_len;
+    size_t recv_cap;
+
+    /* Fragmented message being reassembled */
+    unsigned char *msg;
+    size_t msg_len;
+    int msg_opcode;
+    bool msg_compressed;
+
+    struct ws_deflate *deflate; /* NULL without permessage-deflate */
+    const char *subprotocol;    /* One of the configured ones, or NULL */
+
+    /* Ring of queued frames, protected by the loop lock */
+    struct ws_frame *queue[QUEUE_FRAMES];
+    unsigned int queue_head;
+    unsigned int queue_count;
+    size_t head_sent;           /* Bytes of the first frame already sent */
+    size_t queued_bytes;        /* Unsent bytes */
+    bool want_write;            /* EPOLLOUT armed */
+    bool failed;                /* Dropped, the loop closes it */
+};
+
+/* Event loop thread */
+struct ws_loop {
+    struct websocket_server *server;
+    pthread_t thread;
+    int epoll_fd;
+    int wake_fd;
+    pthread_mutex_t lock;       /* Connection list and write queues */
+    struct ws_connection *conns;
+
+    /* Output of the connection compressors, loop lock held */
+    unsigned char *deflate_buf;
+    size_t deflate_cap;
 };
 
 /* WebSocket server */
 struct websocket_server {
     int listen_fd;
-    int running;
-    pthread_t accept_thread;
+    atomic_int running;
     struct websocket_config config;
-    struct ws_connection connections[MAX_CONNECTIONS];
-    pthread_mutex_t lock;
+    struct ws_loop *loops;
+    unsigned int loop_count;
+    unsigned int started;       /* Loops with a running thread */
+    atomic_int connection_count;
+
+    /* Compressor of WS_COMPRESSION_SHARED, reset for every message */
+    pthread_mutex_t deflate_lock;
+    z_stream deflate;
+    bool deflate_ready;
+    unsigned char *deflate_buf;
+    size_t deflate_cap;
+
+    /* Statistics */
+    _Atomic uint64_t broadcasts;
+    _Atomic uint64_t frames_skipped;
+    _Atomic uint64_t clients_dropped;
+    _Atomic uint64_t messages_compressed;
+    _Atomic uint64_t bytes_uncompressed;
+    _Atomic uint64_t bytes_compressed;
 };
 
-/* Base64 encode */
-static char *base64_encode(const unsigned char *input, int length) {
-    BIO *bmem, *b64;
-    BUF_MEM *bptr;
-    
-    b64 = BIO_new(BIO_f_base64());
-    bmem = BIO_new(BIO_s_mem());
-    b64 = BIO_push(b64, bmem);
-    BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL);
-    BIO_write(b64, input, length);
-    BIO_flush(b64);
-    BIO_get_mem_ptr(b64, &bptr);
-    
-    char *buff = malloc(bptr->length + 1);
-    memcpy(buff, bptr->data, bptr->length);
-    buff[bptr->length] = 0;
-    
-    BIO_free_all(b64);
-    
-    return buff;
-}
+/* epoll tags of the listening socket and the wakeup eventfd */
+#define LISTEN_TAG ((struct ws_connection *)&listen_tag)
+#define WAKE_TAG ((struct ws_connection *)&wake_tag)
+static const char listen_tag, wake_tag;
 
-/* Parse WebSocket handshake */
+/* Parse WebSocket handshake, request is NUL terminated */
 static int parse_handshake(const char *request, char *key, size_t key_len) {
-    const char *key_header = "Sec-WebSocket-Key: ";
-    const char *key_start = strstr(request, key_header);
+    const char *key_header = "Sec-WebSocket-Key:";
+    const char *key_start = strcasestr(request, key_header);
     
     if (!key_start) return -1;
     
     key_start += strlen(key_header);
+    while (*key_start == ' ' || *key_start == '\t') key_start++;
+    
     const char *key_end = strstr(key_start, "\r\n");
     
     if (!key_end) return -1;
     
     size_t len = key_end - key_start;
-    if (len >= key_len) return -1;
+    if (len == 0 || len >= key_len) return -1;
     
-    strncpy(key, key_start, len);
+    memcpy(key, key_start, len);
     key[len] = '\0';
     
     return 0;
 }
 
-/* Send WebSocket handshake response */
-static int send_handshake_response(int fd, const char *key) {
+/* Parse one permessage-deflate offer, tokens separated by ';'. False if
+ * it is another extension or asks for what we cannot do. */
+static bool parse_deflate_offer(char *offer, enum websocket_compression mode,
+                                struct ws_extension *ext) {
+    char *save = NULL;
+    char *token = strtok_r(offer, ";", &save);
+    bool seen_server_bits = false, seen_client_bits = false;
+    
+    memset(ext, 0, sizeof(*ext));
+    if (!token) return false;
+    
+    token += strspn(token, " \t");
+    if (strncasecmp(token, "permessage-deflate", 18) != 0 ||
+        token[18 + strspn(token + 18, " \t")] != '\0') return false;
+    
+    while ((token = strtok_r(NULL, ";", &save))) {
+        char *value = strchr(token, '=');
+        size_t len;
+    
+        token += strspn(token, " \t");
+        if (value) *value++ = '\0';
+        len = strcspn(token, " \t");
+        token[len] = '\0';
+    
+        if (value) {
+            value += strspn(value, " \t\"");
+            value[strcspn(value, " \t\"")] = '\0';
+        }
+    
+        if (strcasecmp(token, "server_no_context_takeover") == 0) {
+            if (ext->server_no_context || value) return false;
+            ext->server_no_context = true;
+        } else if (strcasecmp(token, "client_no_context_takeover") == 0) {
+            if (ext->client_no_context || value) return false;
+            ext->client_no_context = true;
+        } else if (strcasecmp(token, "server_max_window_bits") == 0) {
+            if (seen_server_bits || !value) return false;
+            seen_server_bits = true;
+            ext->server_window_bits = atoi(value);
+    
+            /* zlib has no raw deflate with a 256 byte window, and the shared
+             * compressor uses the full one */
+            if (ext->server_window_bits < 9 || ext->server_window_bits > 15) return false;
+            if (mode == WS_COMPRESSION_SHARED && ext->server_window_bits != 15) return false;
+        } else if (strcasecmp(token, "client_max_window_bits") == 0) {
+            /* Only a hint to us, we inflate with the full window */
+            if (seen_client_bits) return false;
+            seen_client_bits = true;
+            if (value && (atoi(value) < 8 || atoi(value) > 15)) return false;
+        } else {
+            return false;
+        }
+    }
+    
+    if (mode == WS_COMPRESSION_SHARED) ext->server_no_context = true;
+    ext->deflate = true;
+    
+    return true;
+}
+
+/* Pick the first permessage-deflate offer of the request we can accept */
+static void parse_extensions(const char *request, enum websocket_compression mode,
+                             struct ws_extension *ext) {
+    const char *header = "\r\nSec-WebSocket-Extensions:";
+    const char *start = strcasestr(request, header);
+    char value[512];
+    
+    memset(ext, 0, sizeof(*ext));
+    if (mode == WS_COMPRESSION_OFF || !start) return;
+    
+    start += strlen(header);
+    size_t len = strcspn(start, "\r\n");
+    if (len >= sizeof(value)) return;
+    
+    memcpy(value, start, len);
+    value[len] = '\0';
+    
+    char *save = NULL;
+    for (char *offer = strtok_r(value, ",", &save); offer; offer = strtok_r(NULL, ",", &save)) {
+        if (parse_deflate_offer(offer, mode, ext)) return;
+    }
+    
+    memset(ext, 0, sizeof(*ext));
+}
+
+/* Pick the first configured subprotocol the client offers, or NULL */
+static const char *parse_subprotocol(const char *request, const char *const *accepted) {
+    const char *header = "\r\nSec-WebSocket-Protocol:";
+    const char *start = strcasestr(request, header);
+    
+    if (!accepted || !start) return NULL;
+    
+    start += strlen(header);
+    size_t len = strcspn(start, "\r\n");
+    
+    for (; *accepted; accepted++) {
+        size_t want = strlen(*accepted);
+        const char *p = start, *end = start + len;
+    
+        /* Comma separated tokens, compared exactly */
+        while (p < end) {
+            p += strspn(p, " \t,");
+            size_t token = strcspn(p, " \t,\r\n");
+    
+            if (token == want && memcmp(p, *accepted, want) == 0) return *accepted;
+            p += token;
+        }
+    }
+    
+    return NULL;
+}
+
+/* Build the WebSocket handshake response */
+static int build_handshake_response(const char *key, const struct ws_extension *ext,
+                                    const char *subprotocol, char *response, size_t size) {
     char accept_key[256];
     unsigned char hash[SHA_DIGEST_LENGTH];
+    unsigned char encoded[4 * ((SHA_DIGEST_LENGTH + 2) / 3) + 1];
     
     /* Concatenate key with GUID */
     snprintf(accept_key, sizeof(accept_key), "%s%s", key, WS_GUID);
@@ -100,226 +338,851 @@ static int send_handshake_response(int fd, const char *key) {
     SHA1((unsigned char *)accept_key, strlen(accept_key), hash);
     
     /* Base64 encode */
-    char *encoded = base64_encode(hash, SHA_DIGEST_LENGTH);
+    EVP_EncodeBlock(encoded, hash, SHA_DIGEST_LENGTH);
     
-    /* Send response */
-    char response[512];
-    int len = snprintf(response, sizeof(response),
+    char extension[160] = "";
+    if (ext->deflate) {
+        char bits[32] = "";
+    
+        if (ext->server_window_bits) {
+            snprintf(bits, sizeof(bits), "; server_max_window_bits=%d", ext->server_window_bits);
+        }
+        snprintf(extension, sizeof(extension),
+                 "Sec-WebSocket-Extensions: permessage-deflate%s%s%s\r\n",
+                 ext->server_no_context ? "; server_no_context_takeover" : "",
+                 ext->client_no_context ? "; client_no_context_takeover" : "", bits);
+    }
+    
+    char protocol[96] = "";
+    if (subprotocol) {
+        snprintf(protocol, sizeof(protocol), "Sec-WebSocket-Protocol: %s\r\n", subprotocol);
+    }
+    
+    return snprintf(response, size,
         "HTTP/1.1 101 Switching Protocols\r\n"
         "Upgrade: websocket\r\n"
         "Connection: Upgrade\r\n"
         "Sec-WebSocket-Accept: %s\r\n"
-        "\r\n", encoded);
-    
-    free(encoded);
-    
-    int ret = send(fd, response, len, 0);
-    
-    return ret == len ? 0 : -1;
+        "%s%s"
+        "\r\n", encoded, extension, protocol);
 }
 
-/* Decode WebSocket frame */
-static int decode_frame(const unsigned char *data, size_t len,
-                        unsigned char *payload, size_t *payload_len,
-                        int *opcode) {
-    if (len < 2) return -1;
-    
-    int fin = (data[0] & 0x80) != 0;
-    (void)fin; /* Reserved for future fragmentation support */
-    *opcode = data[0] & 0x0F;
-    int masked = (data[1] & 0x80) != 0;
-    uint64_t payload_length = data[1] & 0x7F;
+/* Encode WebSocket frame header */
+static size_t encode_frame_header(size_t payload_len, unsigned char *header, int opcode) {
+    header[0] = 0x80 | (opcode & 0x0F);  /* FIN + opcode */
     
     size_t offset = 2;
     
-    /* Extended payload length */
-    if (payload_length == 126) {
-        if (len < 4) return -1;
-        payload_length = (data[2] << 8) | data[3];
+    if (payload_len < 126) {
+        header[1] = payload_len;
+    } else if (payload_len < 65536) {
+        header[1] = 126;
+        header[2] = (payload_len >> 8) & 0xFF;
+        header[3] = payload_len & 0xFF;
         offset = 4;
-    } else if (payload_length == 127) {
-        if (len < 10) return -1;
-        payload_length = 0;
+    } else {
+        header[1] = 127;
         for (int i = 0; i < 8; i++) {
-            payload_length = (payload_length << 8) | data[2 + i];
+            header[2 + i] = (payload_len >> (56 - i * 8)) & 0xFF;
         }
         offset = 10;
     }
     
-    /* Masking key */
-    unsigned char mask[4];
-    if (masked) {
-        if (len < offset + 4) return -1;
-        memcpy(mask, data + offset, 4);
-        offset += 4;
+    return offset;
+}
+
+/* Build a frame, without a header for a negative opcode */
+static struct ws_frame *frame_new(int opcode, const void *payload, size_t len) {
+    unsigned char header[10];
+    size_t header_len = opcode < 0 ? 0 : encode_frame_header(len, header, opcode);
+    struct ws_frame *frame = malloc(sizeof(*frame) + header_len + len);
+    
+    if (!frame) return NULL;
+    
+    atomic_init(&frame->refs, 1);
+    frame->skippable = false;
+    frame->compressible = opcode == WS_OPCODE_TEXT || opcode == WS_OPCODE_BINARY;
+    frame->opcode = opcode;
+    frame->header_len = header_len;
+    frame->len = header_len + len;
+    frame->deflate_tried = false;
+    frame->deflated = NULL;
+    memcpy(frame->data, header, header_len);
+    if (len) memcpy(frame->data + header_len, payload, len);
+    
+    return frame;
+}
+
+static void frame_put(struct ws_frame *frame) {
+    if (atomic_fetch_sub(&frame->refs, 1) != 1) return;
+    
+    if (frame->deflated) frame_put(frame->deflated);
+    free(frame);
+}
+
+/* Compress a message ending on a sync flush into *buf, grown as needed.
+ * Returns the length without the trailing 00 00 ff ff, -1 on error. */
+static ssize_t deflate_payload(z_stream *zs, const unsigned char *data, size_t len,
+                               unsigned char **buf, size_t *cap) {
+    size_t need = deflateBound(zs, len) + 16;
+    size_t out = 0;
+    
+    zs->next_in = (unsigned char *)data;
+    zs->avail_in = len;
+    
+    for (;;) {
+        if (*cap < need) {
+            unsigned char *grown = realloc(*buf, need);
+            if (!grown) return -1;
+            *buf = grown;
+            *cap = need;
+        }
+    
+        zs->next_out = *buf + out;
+        zs->avail_out = *cap - out;
+    
+        int ret = deflate(zs, Z_SYNC_FLUSH);
+        if (ret != Z_OK && ret != Z_BUF_ERROR) return -1;
+    
+        out = *cap - zs->avail_out;
+        if (zs->avail_out) break;
+        need = *cap * 2;
+    }
+    
+    if (out < 4) return -1;
+    
+    return out - 4;
+}
+
+/* Build the compressed frame of a message */
+static struct ws_frame *frame_compressed(const struct ws_frame *frame,
+                                         const unsigned char *payload, size_t len) {
+    struct ws_frame *out = frame_new(frame->opcode, payload, len);
+    
+    if (!out) return NULL;
+    
+    out->data[0] |= WS_RSV1;
+    out->compressible = false;
+    
+    return out;
+}
+
+/* The compressed variant of a frame shared by every client without context
+ * takeover, compressed on first use. NULL to send it as it is. */
+static struct ws_frame *frame_deflated(struct websocket_server *server, struct ws_frame *frame) {
+    struct ws_frame *out;
+    
+    pthread_mutex_lock(&server->deflate_lock);
+    
+    if (!frame->deflate_tried && server->deflate_ready) {
+        size_t len = frame->len - frame->header_len;
+        ssize_t n;
+    
+        frame->deflate_tried = true;
+        deflateReset(&server->deflate);
+        n = deflate_payload(&server->deflate, frame->data + frame->header_len, len,
+                            &server->deflate_buf, &server->deflate_cap);
+    
+        if (n >= 0 && (size_t)n < len) {
+            frame->deflated = frame_compressed(frame, server->deflate_buf, n);
+            if (frame->deflated) frame->deflated->skippable = frame->skippable;
+        }
     }
     
-    /* Check if we have complete payload */
-    if (len < offset + payload_length) return -1;
+    out = frame->deflated;
+    if (out) atomic_fetch_add(&out->refs, 1);
+    
+    pthread_mutex_unlock(&server->deflate_lock);
     
-    /* Decode payload */
-    if (payload_length > *payload_len) {
-        payload_length = *payload_len;
+    return out;
+}
+
+/* The frame to write for a queued frame, a new reference or NULL on error.
+ * A client with context takeover gets its messages compressed here, right
+ * before they go out, so its compressor sees them in the order it inflates
+ * them and skipped broadcasts never reach it. Loop lock held. */
+static struct ws_frame *conn_encode(struct ws_connection *conn, struct ws_frame *frame) {
+    struct ws_deflate *deflate = conn->deflate;
+    struct websocket_server *server = conn->server;
+    size_t len = frame->len - frame->header_len;
+    struct ws_frame *out;
+    
+    if (!deflate || !frame->compressible || len < DEFLATE_MIN) {
+        atomic_fetch_add(&frame->refs, 1);
+        return frame;
     }
     
-    for (size_t i = 0; i < payload_length; i++) {
-        payload[i] = masked ? (data[offset + i] ^ mask[i % 4]) : data[offset + i];
+    if (deflate->shared) {
+        out = frame_deflated(server, frame);
+        if (!out) {
+            atomic_fetch_add(&frame->refs, 1);
+            return frame;
+        }
+    } else {
+        struct ws_loop *loop = conn->loop;
+    
+        if (!deflate->out_ready) {
+            if (deflateInit2(&deflate->out, DEFLATE_LEVEL, Z_DEFLATED, -deflate->window_bits,
+                             DEFLATE_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) return NULL;
+            deflate->out_ready = true;
+        }
+        if (deflate->no_context) deflateReset(&deflate->out);
+    
+        ssize_t n = deflate_payload(&deflate->out, frame->data + frame->header_len, len,
+                                    &loop->deflate_buf, &loop->deflate_cap);
+        if (n < 0) return NULL;
+    
+        /* The client's window now holds this message, it cannot be skipped */
+        out = frame_compressed(frame, loop->deflate_buf, n);
+        if (!out) return NULL;
     }
     
-    *payload_len = payload_length;
+    size_t compressed = out->len - out->header_len;
+    
+    deflate->messages++;
+    deflate->bytes_in += len;
+    deflate->bytes_out += compressed;
+    atomic_fetch_add(&server->messages_compressed, 1);
+    atomic_fetch_add(&server->bytes_uncompressed, len);
+    atomic_fetch_add(&server->bytes_compressed, compressed);
     
-    return offset + payload_length;
+    return out;
 }
 
-/* Encode WebSocket frame */
-static int encode_frame(const unsigned char *payload, size_t payload_len,
-                        unsigned char *frame, size_t frame_size, int opcode) {
-    if (frame_size < 2 + payload_len) return -1;
+/* Arm or disarm EPOLLOUT, loop lock held */
+static void conn_want_write(struct ws_connection *conn, bool want) {
+    struct epoll_event ev = {
+        .events = EPOLLIN | EPOLLRDHUP | (want ? EPOLLOUT : 0),
+        .data.ptr = conn,
+    };
     
-    frame[0] = 0x80 | (opcode & 0x0F);  /* FIN + opcode */
+    if (conn->want_write == want) return;
     
-    size_t offset = 2;
+    conn->want_write = want;
+    epoll_ctl(conn->loop->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+/* Drop a connection from any thread, loop lock held. The loop closes it
+ * once the hangup is reported. */
+static void conn_fail(struct ws_connection *conn) {
+    if (conn->failed) return;
     
-    if (payload_len < 126) {
-        frame[1] = payload_len;
-    } else if (payload_len < 65536) {
-        frame[1] = 126;
-        frame[2] = (payload_len >> 8) & 0xFF;
-        frame[3] = payload_len & 0xFF;
-        offset = 4;
-    } else {
-        frame[1] = 127;
-        for (int i = 0; i < 8; i++) {
-            frame[2 + i] = (payload_len >> (56 - i * 8)) & 0xFF;
+    conn->failed = true;
+    shutdown(conn->fd, SHUT_RDWR);
+}
+
+/* Write queued frames until the socket is full, loop lock held */
+static void conn_flush(struct ws_connection *conn) {
+    while (conn->queue_count && !conn->failed) {
+        struct iovec iov[MAX_IOV];
+        struct msghdr msg = { .msg_iov = iov };
+        size_t skip = conn->head_sent;
+    
+        for (unsigned int i = 0; i < conn->queue_count && i < MAX_IOV; i++) {
+            unsigned int slot = (conn->queue_head + i) % QUEUE_FRAMES;
+            struct ws_frame *frame = conn->queue[slot];
+    
+            /* Compress what goes out now, in order */
+            if (conn->deflate && frame->compressible) {
+                struct ws_frame *wire = conn_encode(conn, frame);
+    
+                if (!wire) {
+                    conn_fail(conn);
+                    return;
+                }
+                conn->queued_bytes += wire->len;
+                conn->queued_bytes -= frame->len;
+                conn->queue[slot] = wire;
+                frame_put(frame);
+                frame = wire;
+            }
+    
+            iov[i].iov_base = frame->data + skip;
+            iov[i].iov_len = frame->len - skip;
+            msg.msg_iovlen++;
+            skip = 0;
+        }
+    
+        ssize_t n = sendmsg(conn->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                conn_want_write(conn, true);
+                return;
+            }
+            conn_fail(conn);
+            return;
+        }
+    
+        conn->queued_bytes -= n;
+        while (n > 0) {
+            struct ws_frame *frame = conn->queue[conn->queue_head];
+            size_t left = frame->len - conn->head_sent;
+    
+            if ((size_t)n < left) {
+                conn->head_sent += n;
+                break;
+            }
+    
+            n -= left;
+            frame_put(frame);
+            conn->queue_head = (conn->queue_head + 1) % QUEUE_FRAMES;
+            conn->queue_count--;
+            conn->head_sent = 0;
         }
-        offset = 10;
     }
     
-    memcpy(frame + offset, payload, payload_len);
+    if (conn->failed) return;
+    
+    conn_want_write(conn, false);
     
-    return offset + payload_len;
+    /* Our close frame is out, wait for the peer to close */
+    if (conn->state == WS_STATE_CLOSING) shutdown(conn->fd, SHUT_WR);
 }
 
-/* Connection handler thread */
-static void *connection_handler(void *arg) {
-    struct ws_connection *conn = arg;
+/* Make room for len more bytes in the queue, skipping the oldest
+ * broadcasts not yet started if the server is configured to. False if
+ * the client has to be dropped. */
+static bool conn_make_room(struct ws_connection *conn, size_t len) {
     struct websocket_server *server = conn->server;
-    char buffer[BUFFER_SIZE];
-    int handshake_done = 0;
     
-    while (conn->active) {
-        int n = recv(conn->fd, buffer, sizeof(buffer) - 1, 0);
-        
-        if (n <= 0) {
+    while (conn->queue_count == QUEUE_FRAMES || conn->queued_bytes + len > MAX_QUEUED) {
+        unsigned int i = conn->head_sent ? 1 : 0;
+    
+        if (server->config.slow_client != WS_SLOW_CLIENT_SKIP) return false;
+    
+        for (; i < conn->queue_count; i++) {
+            if (conn->queue[(conn->queue_head + i) % QUEUE_FRAMES]->skippable) break;
+        }
+        if (i == conn->queue_count) return false;
+    
+        struct ws_frame *frame = conn->queue[(conn->queue_head + i) % QUEUE_FRAMES];
+    
+        /* Close the gap, newer frames keep their order */
+        for (; i + 1 < conn->queue_count; i++) {
+            conn->queue[(conn->queue_head + i) % QUEUE_FRAMES] =
+                conn->queue[(conn->queue_head + i + 1) % QUEUE_FRAMES];
+        }
+        conn->queue_count--;
+        conn->queued_bytes -= frame->len;
+        frame_put(frame);
+        atomic_fetch_add(&server->frames_skipped, 1);
+    }
+    
+    return true;
+}
+
+/* Send a frame, queueing a reference to what the socket does not take.
+ * Loop lock held. */
+static int conn_send(struct ws_connection *conn, struct ws_frame *frame) {
+    size_t sent = 0;
+    
+    if (conn->failed) return -1;
+    
+    /* Our reference, handed to the queue if the frame has to wait */
+    atomic_fetch_add(&frame->refs, 1);
+    
+    /* Nothing queued ahead, try the socket directly */
+    if (!conn->queue_count) {
+        struct ws_frame *wire = conn_encode(conn, frame);
+        ssize_t n;
+    
+        frame_put(frame);
+        if (!wire) {
+            conn_fail(conn);
+            return -1;
+        }
+        frame = wire;
+    
+        do {
+            n = send(conn->fd, frame->data, frame->len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        } while (n < 0 && errno == EINTR);
+    
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            frame_put(frame);
+            conn_fail(conn);
+            return -1;
+        }
+        if (n == (ssize_t)frame->len) {
+            frame_put(frame);
+            return 0;
+        }
+        if (n > 0) sent = n;
+    }
+    
+    /* A client that does not keep up is never buffered without bound */
+    if (!conn_make_room(conn, frame->len - sent)) {
+        frame_put(frame);
+        atomic_fetch_add(&conn->server->clients_dropped, 1);
+        conn_fail(conn);
+        return -1;
+    }
+    
+    conn->queue[(conn->queue_head + conn->queue_count) % QUEUE_FRAMES] = frame;
+    if (!conn->queue_count) conn->head_sent = sent;
+    conn->queue_count++;
+    conn->queued_bytes += frame->len - sent;
+    
+    conn_want_write(conn, true);
+    
+    return 0;
+}
+
+/* Queue a control frame, loop lock taken */
+static void conn_send_control(struct ws_connection *conn, int opcode,
+                              const void *payload, size_t len) {
+    struct ws_frame *frame = frame_new(opcode, payload, len);
+    
+    pthread_mutex_lock(&conn->loop->lock);
+    if (frame) conn_send(conn, frame);
+    else conn_fail(conn);
+    if (opcode == WS_OPCODE_CLOSE) {
+        conn->state = WS_STATE_CLOSING;
+        if (!conn->queue_count) conn_flush(conn);
+    }
+    pthread_mutex_unlock(&conn->loop->lock);
+    
+    if (frame) frame_put(frame);
+}
+
+/* Start the closing handshake with a status code */
+static void conn_close_with(struct ws_connection *conn, unsigned int code) {
+    unsigned char status[2] = { code >> 8, code & 0xFF };
+    
+    conn_send_control(conn, WS_OPCODE_CLOSE, status, sizeof(status));
+}
+
+/* Decompress a client message into the connection's inflate buffer.
+ * Returns its length, -1 if it is corrupt or WS_CLOSE_TOO_BIG as a
+ * negative if it inflates to more than MAX_MESSAGE. */
+static ssize_t conn_inflate(struct ws_connection *conn, const unsigned char *data, size_t len) {
+    static const unsigned char tail[4] = { 0x00, 0x00, 0xff, 0xff };
+    struct ws_deflate *deflate = conn->deflate;
+    z_stream *zs = &deflate->in;
+    bool tail_fed = false, room = true;
+    size_t out = 0;
+    
+    if (!deflate->in_ready) {
+        if (inflateInit2(zs, -15) != Z_OK) return -1;
+        deflate->in_ready = true;
+    }
+    
+    zs->next_in = (unsigned char *)data;
+    zs->avail_in = len;
+    
+    for (;;) {
+        /* The message is complete once the flush marker is consumed */
+        if (!zs->avail_in && room) {
+            if (tail_fed) break;
+            zs->next_in = (unsigned char *)tail;
+            zs->avail_in = sizeof(tail);
+            tail_fed = true;
+        }
+    
+        /* One spare byte for the NUL */
+        if (out + 1 >= deflate->in_cap) {
+            size_t cap = deflate->in_cap ? deflate->in_cap * 2 : RECV_CHUNK;
+    
+            if (deflate->in_cap >= MAX_MESSAGE + 2) return -WS_CLOSE_TOO_BIG;
+            if (cap > MAX_MESSAGE + 2) cap = MAX_MESSAGE + 2;
+    
+            unsigned char *buf = realloc(deflate->in_buf, cap);
+            if (!buf) return -1;
+    
+            deflate->in_buf = buf;
+            deflate->in_cap = cap;
+        }
+    
+        zs->next_out = deflate->in_buf + out;
+        zs->avail_out = deflate->in_cap - out - 1;
+    
+        int ret = inflate(zs, Z_SYNC_FLUSH);
+    
+        out = zs->next_out - deflate->in_buf;
+        room = zs->avail_out > 0;
+    
+        if (ret == Z_STREAM_END) {
+            /* A final block, the next message starts a new stream */
+            inflateReset(zs);
             break;
         }
-        
-        buffer[n] = '\0';
-        
-        if (!handshake_done) {
-            /* Handle WebSocket handshake */
-            char key[256];
-            if (parse_handshake(buffer, key, sizeof(key)) == 0) {
-                if (send_handshake_response(conn->fd, key) == 0) {
-                    handshake_done = 1;
-                    if (server->config.on_connect) {
-                        server->config.on_connect(conn, server->config.user_data);
-                    }
-                } else {
-                    break;
-                }
-            } else {
+        if (ret != Z_OK && (ret != Z_BUF_ERROR || (room && zs->avail_in))) return -1;
+    }
+    
+    if (out > MAX_MESSAGE) return -WS_CLOSE_TOO_BIG;
+    
+    return out;
+}
+
+/* Hand a complete message to the callback, NUL terminated in place */
+static void deliver_message(struct ws_connection *conn, unsigned char *data, size_t len,
+                            bool compressed) {
+    struct websocket_server *server = conn->server;
+    
+    if (!server->config.on_message) return;
+    
+    if (compressed) {
+        ssize_t n = conn_inflate(conn, data, len);
+    
+        if (n < 0) {
+            conn_close_with(conn, n == -WS_CLOSE_TOO_BIG ? WS_CLOSE_TOO_BIG
+                                                         : WS_CLOSE_INVALID_DATA);
+            return;
+        }
+        data = conn->deflate->in_buf;
+        len = n;
+    }
+    
+    unsigned char saved = data[len];
+    
+    data[len] = '\0';
+    server->config.on_message(conn, (char *)data, len, server->config.user_data);
+    data[len] = saved;
+}
+
+/* Handle one unmasked frame, false to close the connection */
+static bool handle_frame(struct ws_connection *conn, int fin, int opcode, bool compressed,
+                         unsigned char *payload, size_t len) {
+    /* Control frames may arrive between the fragments of a message */
+    if (opcode & 0x8) {
+        if (!fin || len > 125 || compressed) return false;
+    
+        switch (opcode) {
+            case WS_OPCODE_PING:
+                conn_send_control(conn, WS_OPCODE_PONG, payload, len);
                 break;
+    
+            case WS_OPCODE_CLOSE:
+                /* Echo the status code back */
+                conn_send_control(conn, WS_OPCODE_CLOSE, payload, len < 2 ? len : 2);
+                break;
+    
+            default:
+                break;
+        }
+        return true;
+    }
+    
+    if (conn->state != WS_STATE_OPEN) return true;
+    
+    /* Only the first frame of a message carries the compressed bit */
+    if (opcode == WS_OPCODE_CONTINUATION) {
+        if (!conn->msg_opcode || compressed) return false;
+    } else if (opcode == WS_OPCODE_TEXT || opcode == WS_OPCODE_BINARY) {
+        if (conn->msg_opcode) return false;
+        if (fin) {
+            deliver_message(conn, payload, len, compressed);
+            return true;
+        }
+        conn->msg_opcode = opcode;
+        conn->msg_compressed = compressed;
+    } else {
+        return false;
+    }
+    
+    /* Reassemble a fragmented message */
+    if (conn->msg_len + len > MAX_MESSAGE) {
+        conn_close_with(conn, WS_CLOSE_TOO_BIG);
+        return true;
+    }
+    
+    unsigned char *msg = realloc(conn->msg, conn->msg_len + len + 1);
+    if (!msg) return false;
+    
+    memcpy(msg + conn->msg_len, payload, len);
+    conn->msg = msg;
+    conn->msg_len += len;
+    
+    if (fin) {
+        deliver_message(conn, conn->msg, conn->msg_len, conn->msg_compressed);
+        free(conn->msg);
+        conn->msg = NULL;
+        conn->msg_len = 0;
+        conn->msg_opcode = 0;
+    }
+    
+    return true;
+}
+
+/* Parse the complete frames in the receive buffer, false to close */
+static bool parse_frames(struct ws_connection *conn) {
+    size_t pos = 0;
+    
+    while (conn->recv_len - pos >= 2 && conn->state != WS_STATE_CLOSING) {
+        unsigned char *p = conn->recv_buf + pos;
+        size_t avail = conn->recv_len - pos;
+        uint64_t len = p[1] & 0x7F;
+        size_t offset = 2;
+    
+        /* Client frames are always masked, RSV1 only marks compression */
+        unsigned int rsv = p[0] & 0x70;
+        if (!(p[1] & 0x80) || (rsv && (rsv != WS_RSV1 || !conn->deflate))) {
+            conn_close_with(conn, WS_CLOSE_PROTOCOL_ERROR);
+            break;
+        }
+    
+        if (len == 126) {
+            if (avail < 4) break;
+            len = (p[2] << 8) | p[3];
+            offset = 4;
+        } else if (len == 127) {
+            if (avail < 10) break;
+            len = 0;
+            for (int i = 0; i < 8; i++) {
+                len = (len << 8) | p[2 + i];
             }
-        } else {
-            /* Handle WebSocket frame */
-            unsigned char payload[BUFFER_SIZE];
-            size_t payload_len = sizeof(payload);
-            int opcode;
-            
-            int frame_len = decode_frame((unsigned char *)buffer, n,
-                                         payload, &payload_len, &opcode);
-            
-            if (frame_len > 0) {
-                switch (opcode) {
-                    case WS_OPCODE_TEXT:
-                    case WS_OPCODE_BINARY:
-                        if (server->config.on_message) {
-                            payload[payload_len] = '\0';
-                            server->config.on_message(conn, (char *)payload,
-                                                     payload_len,
-                                                     server->config.user_data);
-                        }
-                        break;
-                    
-                    case WS_OPCODE_CLOSE:
-                        conn->active = 0;
-                        break;
-                    
-                    case WS_OPCODE_PING:
-                        /* Send pong */
-                        websocket_send(conn, (char *)payload, payload_len);
-                        break;
-                    
-                    default:
-                        break;
-                }
-            }
+            offset = 10;
+        }
+    
+        if (len > MAX_MESSAGE) {
+            conn_close_with(conn, WS_CLOSE_TOO_BIG);
+            break;
+        }
+    
+        /* Wait for the rest of the frame */
+        if (avail < offset + 4 + len) break;
+    
+        const unsigned char *mask = p + offset;
+        unsigned char *payload = p + offset + 4;
+    
+        for (size_t i = 0; i < len; i++) {
+            payload[i] ^= mask[i % 4];
+        }
+    
+        pos += offset + 4 + len;
+    
+        if (!handle_frame(conn, p[0] & 0x80, p[0] & 0x0F, rsv != 0, payload, len)) return false;
+    }
+    
+    if (conn->state == WS_STATE_CLOSING) {
+        conn->recv_len = 0;
+        return true;
+    }
+    
+    memmove(conn->recv_buf, conn->recv_buf + pos, conn->recv_len - pos);
+    conn->recv_len -= pos;
+    
+    return true;
+}
+
+/* Answer the upgrade request once it is complete, false to close */
+static bool parse_upgrade(struct ws_connection *conn) {
+    struct websocket_server *server = conn->server;
+    unsigned char *end = memmem(conn->recv_buf, conn->recv_len, "\r\n\r\n", 4);
+    char key[256];
+    char response[512];
+    
+    if (!end) return conn->recv_len < HANDSHAKE_MAX;
+    
+    end[2] = '\0';
+    if (parse_handshake((char *)conn->recv_buf, key, sizeof(key)) != 0) return false;
+    
+    struct ws_extension ext;
+    parse_extensions((char *)conn->recv_buf, server->config.compression, &ext);
+    if (ext.deflate) {
+        conn->deflate = calloc(1, sizeof(*conn->deflate));
+        if (!conn->deflate) return false;
+    
+        conn->deflate->shared = server->config.compression == WS_COMPRESSION_SHARED;
+        conn->deflate->no_context = ext.server_no_context;
+        conn->deflate->window_bits = ext.server_window_bits ? ext.server_window_bits : 15;
+    }
+    
+    conn->subprotocol = parse_subprotocol((char *)conn->recv_buf, server->config.subprotocols);
+    
+    int len = build_handshake_response(key, &ext, conn->subprotocol, response, sizeof(response));
+    struct ws_frame *frame = frame_new(-1, response, len);
+    
+    if (!frame) return false;
+    
+    pthread_mutex_lock(&conn->loop->lock);
+    int ret = conn_send(conn, frame);
+    if (ret == 0) conn->state = WS_STATE_OPEN;
+    pthread_mutex_unlock(&conn->loop->lock);
+    
+    frame_put(frame);
+    
+    if (ret != 0) return false;
+    
+    /* Frames sent right behind the request */
+    size_t used = end + 4 - conn->recv_buf;
+    memmove(conn->recv_buf, conn->recv_buf + used, conn->recv_len - used);
+    conn->recv_len -= used;
+    
+    if (server->config.on_connect) {
+        server->config.on_connect(conn, server->config.user_data);
+    }
+    
+    return true;
+}
+
+/* Read what has arrived and act on it, false to close */
+static bool conn_read(struct ws_connection *conn) {
+    for (;;) {
+        if (conn->recv_len == conn->recv_cap) {
+            size_t limit = conn->state == WS_STATE_HANDSHAKE ? HANDSHAKE_MAX
+                                                              : MAX_MESSAGE + 14;
+            size_t cap = conn->recv_cap * 2;
+    
+            if (conn->recv_cap >= limit) return false;
+            if (cap > limit) cap = limit;
+    
+            unsigned char *buf = realloc(conn->recv_buf, cap + 1);
+            if (!buf) return false;
+    
+            conn->recv_buf = buf;
+            conn->recv_cap = cap;
+        }
+    
+        ssize_t n = recv(conn->fd, conn->recv_buf + conn->recv_len,
+                         conn->recv_cap - conn->recv_len, 0);
+    
+        if (n == 0) return false;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
         }
+    
+        conn->recv_len += n;
+    
+        if (conn->state == WS_STATE_HANDSHAKE && !parse_upgrade(conn)) return false;
+        if (conn->state != WS_STATE_HANDSHAKE && !parse_frames(conn)) return false;
     }
+}
+
+/* Close a connection of this loop, called from the loop thread only */
+static void conn_close(struct ws_loop *loop, struct ws_connection *conn) {
+    struct websocket_server *server = loop->server;
     
-    if (server->config.on_disconnect) {
+    if (conn->state != WS_STATE_HANDSHAKE && server->config.on_disconnect) {
         server->config.on_disconnect(conn, server->config.user_data);
     }
     
+    pthread_mutex_lock(&loop->lock);
+    if (conn->prev) conn->prev->next = conn->next;
+    else loop->conns = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    pthread_mutex_unlock(&loop->lock);
+    
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
     close(conn->fd);
-    conn->active = 0;
+    atomic_fetch_sub(&server->connection_count, 1);
     
-    return NULL;
+    for (unsigned int i = 0; i < conn->queue_count; i++) {
+        frame_put(conn->queue[(conn->queue_head + i) % QUEUE_FRAMES]);
+    }
+    if (conn->deflate) {
+        if (conn->deflate->out_ready) deflateEnd(&conn->deflate->out);
+        if (conn->deflate->in_ready) inflateEnd(&conn->deflate->in);
+        free(conn->deflate->in_buf);
+        free(conn->deflate);
+    }
+    free(conn->recv_buf);
+    free(conn->msg);
+    free(conn);
 }
 
-/* Accept thread */
-static void *accept_thread(void *arg) {
-    struct websocket_server *server = arg;
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
+static void accept_connections(struct ws_loop *loop) {
+    struct websocket_server *server = loop->server;
     
-    while (server->running) {
-        int client_fd = accept(server->listen_fd,
-                               (struct sockaddr *)&client_addr, &client_len);
-        
-        if (client_fd < 0) {
-            if (server->running) {
-                perror("accept");
-            }
+    for (int i = 0; i < ACCEPT_BATCH; i++) {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+    
+        if (atomic_fetch_add(&server->connection_count, 1) >= MAX_CONNECTIONS) {
+            atomic_fetch_sub(&server->connection_count, 1);
+            close(fd);
             continue;
         }
-        
-        /* Find free connection slot */
-        pthread_mutex_lock(&server->lock);
-        
-        struct ws_connection *conn = NULL;
-        for (int i = 0; i < MAX_CONNECTIONS; i++) {
-            if (!server->connections[i].active) {
-                conn = &server->connections[i];
-                conn->fd = client_fd;
-                conn->active = 1;
-                conn->server = server;
-                conn->user_data = NULL;
-                break;
-            }
+    
+        struct ws_connection *conn = calloc(1, sizeof(*conn));
+        if (conn) conn->recv_buf = malloc(RECV_CHUNK + 1);
+        if (!conn || !conn->recv_buf) {
+            free(conn);
+            atomic_fetch_sub(&server->connection_count, 1);
+            close(fd);
+            continue;
         }
-        
-        pthread_mutex_unlock(&server->lock);
-        
-        if (conn) {
-            pthread_create(&conn->thread, NULL, connection_handler, conn);
-            pthread_detach(conn->thread);
-        } else {
-            close(client_fd);
+    
+        conn->fd = fd;
+        conn->state = WS_STATE_HANDSHAKE;
+        conn->loop = loop;
+        conn->server = server;
+        conn->recv_cap = RECV_CHUNK;
+    
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = conn };
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            free(conn->recv_buf);
+            free(conn);
+            atomic_fetch_sub(&server->connection_count, 1);
+            close(fd);
+            continue;
+        }
+    
+        pthread_mutex_lock(&loop->lock);
+        conn->next = loop->conns;
+        if (loop->conns) loop->conns->prev = conn;
+        loop->conns = conn;
+        pthread_mutex_unlock(&loop->lock);
+    }
+}
+
+/* Event loop thread */
+static void *loop_thread(void *arg) {
+    struct ws_loop *loop = arg;
+    struct websocket_server *server = loop->server;
+    struct epoll_event events[MAX_EVENTS];
+    
+    nlmon_heartbeat_register("ws-loop", NULL, NULL);
+    
+    while (atomic_load(&server->running)) {
+        int n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, -1);
+    
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+    
+        nlmon_heartbeat_enter("websocket");
+        for (int i = 0; i < n; i++) {
+            struct ws_connection *conn = events[i].data.ptr;
+            uint32_t mask = events[i].events;
+    
+            if (conn == LISTEN_TAG) {
+                accept_connections(loop);
+                continue;
+            }
+            if (conn == WAKE_TAG) continue;
+    
+            if (mask & EPOLLOUT) {
+                pthread_mutex_lock(&loop->lock);
+                conn_flush(conn);
+                pthread_mutex_unlock(&loop->lock);
+            }
+    
+            if ((mask & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP)) && !conn_read(conn)) {
+                conn_close(loop, conn);
+                continue;
+            }
+    
+            if (mask & (EPOLLERR | EPOLLHUP)) {
+                conn_close(loop, conn);
+            }
         }
+        nlmon_heartbeat_leave(NULL);
     }
     
+    /* Stopping, close what is left */
+    while (loop->conns) {
+        conn_close(loop, loop->conns);
+    }
+    
+    nlmon_heartbeat_unregister();
     return NULL;
 }
 
@@ -331,23 +1194,76 @@ struct websocket_server *websocket_server_init(struct websocket_config *config)
     if (!server) return NULL;
     
     server->config = *config;
+    if (config->cpus) {
+        server->config.cpus = strdup(config->cpus);
+        if (!server->config.cpus) {
+            free(server);
+            return NULL;
+        }
+    }
     server->listen_fd = -1;
-    server->running = 0;
-    pthread_mutex_init(&server->lock, NULL);
-    
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
-        server->connections[i].active = 0;
+    server->loop_count = config->threads ? config->threads : 1;
+    atomic_init(&server->running, 0);
+    atomic_init(&server->connection_count, 0);
+    pthread_mutex_init(&server->deflate_lock, NULL);
+    
+    if (config->compression == WS_COMPRESSION_SHARED) {
+        if (deflateInit2(&server->deflate, DEFLATE_LEVEL, Z_DEFLATED, -15,
+                         DEFLATE_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+            pthread_mutex_destroy(&server->deflate_lock);
+            free((char *)server->config.cpus);
+            free(server);
+            return NULL;
+        }
+        server->deflate_ready = true;
     }
     
     return server;
 }
 
+/* Create the epoll instance and wakeup eventfd of a loop */
+static int loop_init(struct websocket_server *server, struct ws_loop *loop) {
+    struct epoll_event ev;
+    
+    loop->server = server;
+    loop->wake_fd = -1;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) return -1;
+    
+    loop->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (loop->wake_fd < 0) goto err;
+    
+    /* Each connection wakes only one of the loops */
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = LISTEN_TAG;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &ev) < 0) goto err;
+    
+    ev.events = EPOLLIN;
+    ev.data.ptr = WAKE_TAG;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev) < 0) goto err;
+    
+    pthread_mutex_init(&loop->lock, NULL);
+    return 0;
+    
+err:
+    if (loop->wake_fd >= 0) close(loop->wake_fd);
+    close(loop->epoll_fd);
+    return -1;
+}
+
+static void loop_free(struct ws_loop *loop) {
+    free(loop->deflate_buf);
+    pthread_mutex_destroy(&loop->lock);
+    close(loop->wake_fd);
+    close(loop->epoll_fd);
+}
+
 /* Start WebSocket server */
 int websocket_server_start(struct websocket_server *server) {
-    if (!server) return -1;
+    if (!server || server->loops) return -1;
     
     /* Create socket */
-    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    server->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (server->listen_fd < 0) {
         perror("socket");
         return -1;
@@ -366,46 +1282,75 @@ int websocket_server_start(struct websocket_server *server) {
     
     if (bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
         perror("bind");
-        close(server->listen_fd);
-        return -1;
+        goto err_close;
     }
     
     /* Listen */
-    if (listen(server->listen_fd, 10) < 0) {
+    if (listen(server->listen_fd, SOMAXCONN) < 0) {
         perror("listen");
-        close(server->listen_fd);
-        return -1;
+        goto err_close;
     }
     
-    /* Start accept thread */
-    server->running = 1;
-    pthread_create(&server->accept_thread, NULL, accept_thread, server);
+    server->loops = calloc(server->loop_count, sizeof(*server->loops));
+    if (!server->loops) goto err_close;
+    
+    unsigned int i;
+    for (i = 0; i < server->loop_count; i++) {
+        if (loop_init(server, &server->loops[i]) != 0) goto err_loops;
+    }
+    
+    /* Start loop threads */
+    atomic_store(&server->running, 1);
+    for (; server->started < server->loop_count; server->started++) {
+        struct ws_loop *loop = &server->loops[server->started];
+    
+        if (pthread_create(&loop->thread, NULL, loop_thread, loop) != 0) {
+            websocket_server_stop(server);
+            return -1;
+        }
+        thread_affinity_apply(loop->thread, server->config.cpus,
+                              server->loop_count > 1 ? (int)server->started : -1, "ws-loop");
+    }
     
     printf("WebSocket server started on port %d\n", server->config.port);
     
     return 0;
+    
+err_loops:
+    while (i-- > 0) {
+        loop_free(&server->loops[i]);
+    }
+    free(server->loops);
+    server->loops = NULL;
+err_close:
+    close(server->listen_fd);
+    server->listen_fd = -1;
+    return -1;
 }
 
 /* Stop WebSocket server */
 void websocket_server_stop(struct websocket_server *server) {
-    if (!server) return;
+    if (!server || !server->loops) return;
     
-    server->running = 0;
+    atomic_store(&server->running, 0);
     
-    if (server->listen_fd >= 0) {
-        close(server->listen_fd);
-        server->listen_fd = -1;
+    /* Loops close their connections on the way out */
+    for (unsigned int i = 0; i < server->started; i++) {
+        eventfd_write(server->loops[i].wake_fd, 1);
+    }
+    for (unsigned int i = 0; i < server->started; i++) {
+        pthread_join(server->loops[i].thread, NULL);
     }
     
-    /* Close all connections */
-    pthread_mutex_lock(&server->lock);
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
-        if (server->connections[i].active) {
-            server->connections[i].active = 0;
-            close(server->connections[i].fd);
-        }
+    for (unsigned int i = 0; i < server->loop_count; i++) {
+        loop_free(&server->loops[i]);
     }
-    pthread_mutex_unlock(&server->lock);
+    free(server->loops);
+    server->loops = NULL;
+    server->started = 0;
+    
+    close(server->listen_fd);
+    server->listen_fd = -1;
 }
 
 /* Cleanup WebSocket server */
@@ -413,57 +1358,156 @@ void websocket_server_cleanup(struct websocket_server *server) {
     if (!server) return;
     
     websocket_server_stop(server);
-    pthread_mutex_destroy(&server->lock);
+    if (server->deflate_ready) deflateEnd(&server->deflate);
+    free(server->deflate_buf);
+    pthread_mutex_destroy(&server->deflate_lock);
+    free((char *)server->config.cpus);
     free(server);
 }
 
-/* Send message to connection */
-int websocket_send(struct ws_connection *conn, const char *message, size_t len) {
-    if (!conn || !conn->active) return -1;
+/* Send a text or binary message to a connection */
+static int send_message(struct ws_connection *conn, int opcode, const void *message, size_t len) {
+    if (!conn) return -1;
     
-    unsigned char frame[BUFFER_SIZE];
-    int frame_len = encode_frame((unsigned char *)message, len, frame,
-                                 sizeof(frame), WS_OPCODE_TEXT);
+    struct ws_frame *frame = frame_new(opcode, message, len);
+    int ret = -1;
     
-    if (frame_len < 0) return -1;
+    if (!frame) return -1;
     
-    int ret = send(conn->fd, frame, frame_len, 0);
+    pthread_mutex_lock(&conn->loop->lock);
+    if (conn->state == WS_STATE_OPEN) {
+        ret = conn_send(conn, frame);
+    }
+    pthread_mutex_unlock(&conn->loop->lock);
+    
+    frame_put(frame);
     
-    return ret == frame_len ? 0 : -1;
+    return ret;
+}
+
+/* Send message to connection */
+int websocket_send(struct ws_connection *conn, const char *message, size_t len) {
+    return send_message(conn, WS_OPCODE_TEXT, message, len);
+}
+
+int websocket_send_binary(struct ws_connection *conn, const void *data, size_t len) {
+    return send_message(conn, WS_OPCODE_BINARY, data, len);
 }
 
 /* Broadcast message to all connections */
 int websocket_broadcast(struct websocket_server *server, const char *message, size_t len) {
-    if (!server) return -1;
+    if (!server || !server->loops) return -1;
+    
+    /* Encode once, every client queues a reference to the same frame */
+    struct ws_frame *frame = frame_new(WS_OPCODE_TEXT, message, len);
+    if (!frame) return -1;
+    
+    frame->skippable = true;
+    
+    for (unsigned int i = 0; i < server->loop_count; i++) {
+        struct ws_loop *loop = &server->loops[i];
+    
+        pthread_mutex_lock(&loop->lock);
+        for (struct ws_connection *conn = loop->conns; conn; conn = conn->next) {
+            if (conn->state == WS_STATE_OPEN) {
+                conn_send(conn, frame);
+            }
+        }
+        pthread_mutex_unlock(&loop->lock);
+    }
+    
+    frame_put(frame);
+    atomic_fetch_add(&server->broadcasts, 1);
+    
+    return 0;
+}
+
+/* Send one text or binary message to a set of connections */
+static int multicast_message(struct ws_connection **conns, size_t count, int opcode,
+                             const void *message, size_t len) {
+    if (!conns || !count) return 0;
     
-    pthread_mutex_lock(&server->lock);
+    struct ws_frame *frame = frame_new(opcode, message, len);
+    struct ws_loop *locked = NULL;
     
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
-        if (server->connections[i].active) {
-            websocket_send(&server->connections[i], message, len);
+    if (!frame) return -1;
+    
+    frame->skippable = true;
+    
+    /* Connections of one loop tend to be adjacent, keep its lock across them */
+    for (size_t i = 0; i < count; i++) {
+        struct ws_connection *conn = conns[i];
+    
+        if (conn->loop != locked) {
+            if (locked) pthread_mutex_unlock(&locked->lock);
+            locked = conn->loop;
+            pthread_mutex_lock(&locked->lock);
+        }
+        if (conn->state == WS_STATE_OPEN) {
+            conn_send(conn, frame);
         }
     }
+    if (locked) pthread_mutex_unlock(&locked->lock);
     
-    pthread_mutex_unlock(&server->lock);
+    frame_put(frame);
+    atomic_fetch_add(&conns[0]->server->broadcasts, 1);
     
     return 0;
 }
 
+/* Send one message to a set of connections */
+int websocket_multicast(struct ws_connection **conns, size_t count,
+                        const char *message, size_t len) {
+    return multicast_message(conns, count, WS_OPCODE_TEXT, message, len);
+}
+
+int websocket_multicast_binary(struct ws_connection **conns, size_t count,
+                               const void *data, size_t len) {
+    return multicast_message(conns, count, WS_OPCODE_BINARY, data, len);
+}
+
+/* Get the agreed subprotocol, set before the connect callback */
+const char *websocket_get_subprotocol(struct ws_connection *conn) {
+    return conn ? conn->subprotocol : NULL;
+}
+
 /* Get connection count */
 int websocket_get_connection_count(struct websocket_server *server) {
     if (!server) return 0;
     
-    int count = 0;
-    
-    pthread_mutex_lock(&server->lock);
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
-        if (server->connections[i].active) {
-            count++;
-        }
+    return atomic_load(&server->connection_count);
+}
+
+/* Get server statistics */
+void websocket_get_stats(struct websocket_server *server, struct websocket_stats *stats) {
+    if (!server || !stats) return;
+    
+    stats->connections = atomic_load(&server->connection_count);
+    stats->broadcasts = atomic_load(&server->broadcasts);
+    stats->frames_skipped = atomic_load(&server->frames_skipped);
+    stats->clients_dropped = atomic_load(&server->clients_dropped);
+    stats->messages_compressed = atomic_load(&server->messages_compressed);
+    stats->bytes_uncompressed = atomic_load(&server->bytes_uncompressed);
+    stats->bytes_compressed = atomic_load(&server->bytes_compressed);
+}
+
+/* Get connection statistics */
+int websocket_get_connection_stats(struct ws_connection *conn,
+                                   struct websocket_connection_stats *stats) {
+    if (!conn || !stats) return -1;
+    
+    memset(stats, 0, sizeof(*stats));
+    
+    pthread_mutex_lock(&conn->loop->lock);
+    if (conn->deflate) {
+        stats->compressed = 1;
+        stats->messages_compressed = conn->deflate->messages;
+        stats->bytes_uncompressed = conn->deflate->bytes_in;
+        stats->bytes_compressed = conn->deflate->bytes_out;
     }
-    pthread_mutex_unlock(&server->lock);
+    pthread_mutex_unlock(&conn->loop->lock);
     
-    return count;
+    return 0;
 }
 
 /* Set connection user data */
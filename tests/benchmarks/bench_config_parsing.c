@@ -0,0 +1,73 @@
+/* bench_config_parsing.c - Configuration file parsing benchmark */
+
+#include "benchmark_framework.h"
+#include "nlmon_config.h"
+#include <string.h>
+#include <unistd.h>
+
+/* Rules of the generated configuration, as configuration management
+ * writes them: hooks and interface patterns */
+#define BENCH_RULES 10000
+
+static const char *block_file = "/tmp/nlmon_bench_config.yaml";
+static const char *libyaml_file = "/tmp/nlmon_bench_config_libyaml.yaml";
+
+static int write_config(const char *path, bool force_libyaml)
+{
+	FILE *f = fopen(path, "w");
+	
+	if (!f)
+		return -1;
+	
+	fprintf(f, "nlmon:\n  core:\n    buffer_size: 320KB\n    max_events: 10000\n");
+	fprintf(f, "  monitoring:\n    interfaces:\n      include:\n");
+	for (int i = 0; i < BENCH_RULES; i++)
+		fprintf(f, "        - \"veth%d*\"\n", i);
+	fprintf(f, "  integration:\n    hooks:\n");
+	for (int i = 0; i < BENCH_RULES; i++) {
+		fprintf(f, "      - name: hook%d   # generated\n", i);
+		fprintf(f, "        script: /usr/lib/nlmon/hooks/hook%d.sh\n", i);
+		fprintf(f, "        condition: 'interface == \"eth%d\" && msg_type == 16'\n", i);
+		fprintf(f, "        timeout_ms: 5000\n        enabled: true\n");
+	}
+	
+	/* A flow mapping is beyond the in-place parser */
+	if (force_libyaml)
+		fprintf(f, "  web: {enabled: false}\n");
+	
+	fclose(f);
+	return 0;
+}
+
+static void load(const char *path)
+{
+	struct nlmon_config config;
+	
+	nlmon_config_init(&config);
+	if (nlmon_config_load(&config, path) != NLMON_CONFIG_OK)
+		fprintf(stderr, "Failed to load %s\n", path);
+	nlmon_config_free(&config);
+}
+
+BENCHMARK(config_load_10k_rules, 20)
+{
+	load(block_file);
+}
+
+BENCHMARK(config_load_10k_rules_libyaml, 20)
+{
+	load(libyaml_file);
+}
+
+BENCHMARK_SUITE_BEGIN("Configuration Parsing")
+	if (write_config(block_file, false) < 0 || write_config(libyaml_file, true) < 0) {
+		fprintf(stderr, "Failed to write benchmark configuration\n");
+		return 1;
+	}
+
+	RUN_BENCHMARK(config_load_10k_rules);
+	RUN_BENCHMARK(config_load_10k_rules_libyaml);
+
+	unlink(block_file);
+	unlink(libyaml_file);
+BENCHMARK_SUITE_END()
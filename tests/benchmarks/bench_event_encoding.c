@@ -0,0 +1,118 @@
+/* bench_event_encoding.c - Cost and size of JSON and CBOR event encoding */
+
+#include "benchmark_framework.h"
+#include "event_cbor.h"
+#include "event_processor.h"
+#include <string.h>
+
+/* Events per call, rotating over a realistic handful of names */
+#define EVENTS_PER_CALL 1000
+#define INTERFACES 8
+
+static struct nlmon_event events[EVENTS_PER_CALL];
+static struct json_buf out;
+static struct event_cbor_dict *dict;
+
+/* The fields of a CBOR event, in the JSON of the WebSocket stream */
+static void append_json(struct json_buf *json, const struct nlmon_event *event)
+{
+	json_buf_append_str(json, "{\"type\":\"event\",\"data\":{\"timestamp\":");
+	json_buf_append_u64(json, event->timestamp);
+	json_buf_append_str(json, ",\"sequence\":");
+	json_buf_append_u64(json, event->sequence);
+	json_buf_append_str(json, ",\"event_type\":");
+	json_buf_append_u64(json, event->event_type);
+	json_buf_append_str(json, ",\"message_type\":");
+	json_buf_append_u64(json, event->message_type);
+	json_buf_append_str(json, ",\"interface\":");
+	json_buf_append_string(json, event->interface);
+	json_buf_append_str(json, ",\"protocol\":");
+	json_buf_append_i64(json, event->netlink.protocol);
+	json_buf_append_str(json, ",\"family\":");
+	if (event->netlink.genl_family_name[0])
+		json_buf_append_string(json, event->netlink.genl_family_name);
+	else
+		json_buf_append_str(json, "null");
+	json_buf_append_str(json, "}}");
+}
+
+static void append_cbor(struct json_buf *buf, const struct nlmon_event *event)
+{
+	struct event_cbor_record record;
+	
+	event_cbor_record_init(&record, event);
+	event_cbor_append(buf, buf, dict, &record);
+}
+
+THROUGHPUT_BENCHMARK(json_encode, 2.0)
+{
+	for (int i = 0; i < EVENTS_PER_CALL; i++) {
+		json_buf_reset(&out);
+		append_json(&out, &events[i]);
+	}
+	return EVENTS_PER_CALL;
+}
+
+THROUGHPUT_BENCHMARK(cbor_encode, 2.0)
+{
+	for (int i = 0; i < EVENTS_PER_CALL; i++) {
+		json_buf_reset(&out);
+		append_cbor(&out, &events[i]);
+	}
+	return EVENTS_PER_CALL;
+}
+
+/* Bytes of all events, a fresh dictionary's definitions included */
+static size_t encoded_size(void (*append)(struct json_buf *, const struct nlmon_event *))
+{
+	struct event_cbor_dict *saved = dict;
+	size_t bytes = 0;
+	
+	dict = event_cbor_dict_create();
+	for (int i = 0; i < EVENTS_PER_CALL; i++) {
+		json_buf_reset(&out);
+		append(&out, &events[i]);
+		bytes += out.len;
+	}
+	event_cbor_dict_destroy(dict);
+	dict = saved;
+	
+	return bytes;
+}
+
+BENCHMARK_SUITE_BEGIN("Event Encoding")
+	dict = event_cbor_dict_create();
+	if (!dict || !json_buf_init(&out, 4096)) {
+		fprintf(stderr, "Failed to allocate buffers\n");
+		return 1;
+	}
+	
+	for (int i = 0; i < EVENTS_PER_CALL; i++) {
+		struct nlmon_event *event = &events[i];
+	
+		event->timestamp = 1700000000000000000ULL + (uint64_t)i * 1000;
+		event->sequence = 1000000 + (uint64_t)i;
+		event->event_type = (uint32_t)(i % 5);
+		event->message_type = (uint16_t)(16 + i % 4);
+		event->netlink.protocol = i % 4 ? 0 : 16;
+		snprintf(event->interface, sizeof(event->interface), "%s%d",
+		         i % 2 ? "wlan" : "eth", i % INTERFACES);
+		if (event->netlink.protocol == 16)
+			snprintf(event->netlink.genl_family_name,
+			         sizeof(event->netlink.genl_family_name), "nl80211");
+	}
+	
+	RUN_THROUGHPUT_BENCHMARK(json_encode);
+	RUN_THROUGHPUT_BENCHMARK(cbor_encode);
+	
+	size_t json_bytes = encoded_size(append_json);
+	size_t cbor_bytes = encoded_size(append_cbor);
+	
+	printf("\n=== Size per event ===\n");
+	printf("JSON:          %.1f bytes\n", (double)json_bytes / EVENTS_PER_CALL);
+	printf("CBOR:          %.1f bytes (%.0f%% of JSON)\n", (double)cbor_bytes / EVENTS_PER_CALL,
+	       100.0 * (double)cbor_bytes / (double)json_bytes);
+	
+	event_cbor_dict_destroy(dict);
+	json_buf_free(&out);
+BENCHMARK_SUITE_END()
@@ -3,12 +3,25 @@
 #include "benchmark_framework.h"
 #include "event_processor.h"
 #include "ring_buffer.h"
+#include "rate_limiter.h"
 #include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 static struct event_processor *g_processor = NULL;
 static struct ring_buffer *g_ring_buffer = NULL;
+static struct ring_buffer *g_mpmc_ring = NULL;
 static volatile uint64_t g_events_processed = 0;
 
+/* Producer threads feeding one MPMC ring, like several receive threads */
+#define MPMC_PRODUCERS 4
+#define MPMC_ITEMS_PER_PRODUCER 1000000
+#define RING_BULK 32
+
+/* Threads submitting through one rate limiter map */
+#define RATE_LIMITER_THREADS 8
+#define RATE_LIMITER_CALLS 1000000
+
 static void event_callback(struct nlmon_event *event, void *ctx)
 {
 	__sync_fetch_and_add(&g_events_processed, 1);
@@ -31,17 +44,160 @@ THROUGHPUT_BENCHMARK(event_submission, 5.0)
 
 THROUGHPUT_BENCHMARK(ring_buffer_ops, 5.0)
 {
-	int value = 42;
-	int result;
+	static int value = 42;
 	
-	if (ring_buffer_push(g_ring_buffer, &value)) {
-		ring_buffer_pop(g_ring_buffer, &result);
+	if (ring_buffer_enqueue(g_ring_buffer, &value)) {
+		ring_buffer_dequeue(g_ring_buffer);
 		return 1;
 	}
 	
 	return 0;
 }
 
+THROUGHPUT_BENCHMARK(ring_buffer_bulk_ops, 5.0)
+{
+	static int value = 42;
+	void *items[RING_BULK];
+	size_t n;
+	
+	for (n = 0; n < RING_BULK; n++)
+		items[n] = &value;
+	
+	n = ring_buffer_enqueue_bulk(g_ring_buffer, items, RING_BULK);
+	ring_buffer_dequeue_bulk(g_ring_buffer, items, RING_BULK);
+	
+	return n;
+}
+
+THROUGHPUT_BENCHMARK(mpmc_ring_ops, 5.0)
+{
+	static int value = 42;
+	
+	if (ring_buffer_enqueue(g_mpmc_ring, &value)) {
+		ring_buffer_dequeue(g_mpmc_ring);
+		return 1;
+	}
+	
+	return 0;
+}
+
+THROUGHPUT_BENCHMARK(mpmc_ring_bulk_ops, 5.0)
+{
+	static int value = 42;
+	void *items[RING_BULK];
+	size_t n;
+	
+	for (n = 0; n < RING_BULK; n++)
+		items[n] = &value;
+	
+	n = ring_buffer_enqueue_bulk(g_mpmc_ring, items, RING_BULK);
+	ring_buffer_dequeue_bulk(g_mpmc_ring, items, RING_BULK);
+	
+	return n;
+}
+
+static void *mpmc_producer(void *arg)
+{
+	static int value = 42;
+	void *items[RING_BULK];
+	size_t sent = 0, n;
+	
+	(void)arg;
+	for (n = 0; n < RING_BULK; n++)
+		items[n] = &value;
+	
+	while (sent < MPMC_ITEMS_PER_PRODUCER)
+		sent += ring_buffer_enqueue_bulk(g_mpmc_ring, items, RING_BULK);
+	
+	return NULL;
+}
+
+/* Several producers and one consumer on one MPMC ring */
+static void run_mpmc_contended(void)
+{
+	pthread_t producers[MPMC_PRODUCERS];
+	uint64_t start, elapsed, received = 0;
+	uint64_t total = (uint64_t)MPMC_PRODUCERS * MPMC_ITEMS_PER_PRODUCER;
+	void *items[RING_BULK];
+	int i, started = 0;
+	
+	printf("\n=== Throughput Benchmark: mpmc_ring_contended ===\n");
+	printf("Producers: %d\n", MPMC_PRODUCERS);
+	
+	start = benchmark_get_time_ns();
+	for (i = 0; i < MPMC_PRODUCERS; i++) {
+		if (pthread_create(&producers[i], NULL, mpmc_producer, NULL) != 0)
+			break;
+		started++;
+	}
+	
+	total = (uint64_t)started * MPMC_ITEMS_PER_PRODUCER;
+	while (received < total)
+		received += ring_buffer_dequeue_bulk(g_mpmc_ring, items, RING_BULK);
+	
+	for (i = 0; i < started; i++)
+		pthread_join(producers[i], NULL);
+	elapsed = benchmark_get_time_ns() - start;
+	
+	printf("Operations:    %lu\n", (unsigned long)received);
+	printf("Throughput:    %.2f ops/sec\n", received / (elapsed / 1000000000.0));
+}
+
+struct rate_limiter_worker {
+	struct rate_limiter_map *map;
+	uint32_t event_type;
+};
+
+static void *rate_limiter_worker(void *arg)
+{
+	struct rate_limiter_worker *worker = arg;
+	
+	for (int i = 0; i < RATE_LIMITER_CALLS; i++)
+		rate_limiter_map_allow(worker->map, worker->event_type);
+	
+	return NULL;
+}
+
+/* Allow checks from 1 to RATE_LIMITER_THREADS threads, each on its own
+ * event type or all on the same one */
+static void run_rate_limiter_scaling(bool same_type)
+{
+	struct rate_limiter_worker workers[RATE_LIMITER_THREADS];
+	pthread_t threads[RATE_LIMITER_THREADS];
+	struct rate_limiter_map *map;
+	uint64_t start, elapsed;
+	int i, started;
+	
+	printf("\n=== Throughput Benchmark: rate_limiter_map_%s ===\n",
+	       same_type ? "same_type" : "per_type");
+	
+	for (int count = 1; count <= RATE_LIMITER_THREADS; count *= 2) {
+		/* Limits high enough that every check is allowed */
+		map = rate_limiter_map_create(1e9, 1000000);
+		if (!map)
+			return;
+		for (i = 0; i < count; i++) {
+			workers[i].map = map;
+			workers[i].event_type = same_type ? 0 : (uint32_t)i + 1;
+			rate_limiter_map_set(map, workers[i].event_type, 1e9, 1000000);
+		}
+		
+		start = benchmark_get_time_ns();
+		for (started = 0; started < count; started++) {
+			if (pthread_create(&threads[started], NULL, rate_limiter_worker,
+			                   &workers[started]) != 0)
+				break;
+		}
+		for (i = 0; i < started; i++)
+			pthread_join(threads[i], NULL);
+		elapsed = benchmark_get_time_ns() - start;
+		
+		printf("Threads %d:     %.2f ops/sec\n", started,
+		       (double)started * RATE_LIMITER_CALLS / (elapsed / 1000000000.0));
+		rate_limiter_map_destroy(map);
+	}
+}
+
 BENCHMARK(event_creation, 100000)
 {
 	struct nlmon_event event = {0};
@@ -68,19 +224,18 @@ MEMORY_BENCHMARK(event_processor_memory)
 	struct event_processor_config config = {0};
 	struct event_processor *ep;
 	
-	config.buffer_size = 1000;
-	config.worker_threads = 4;
+	config.ring_buffer_size = 1000;
+	config.thread_pool_size = 4;
 	
 	ep = event_processor_create(&config);
 	if (!ep)
 		return 0;
 	
 	/* Estimate memory usage */
-	size_t memory = sizeof(struct event_processor);
-	memory += config.buffer_size * sizeof(struct nlmon_event);
-	memory += config.worker_threads * 8192; /* Stack per thread */
+	size_t memory = config.ring_buffer_size * sizeof(struct nlmon_event);
+	memory += config.thread_pool_size * 8192; /* Stack per thread */
 	
-	event_processor_destroy(ep);
+	event_processor_destroy(ep, false);
 	
 	return memory;
 }
@@ -88,14 +243,13 @@ MEMORY_BENCHMARK(event_processor_memory)
 MEMORY_BENCHMARK(ring_buffer_memory)
 {
 	size_t capacity = 1000;
-	size_t element_size = sizeof(struct nlmon_event);
 	
-	struct ring_buffer *rb = ring_buffer_create(capacity, element_size);
+	struct ring_buffer *rb = ring_buffer_create(capacity);
 	if (!rb)
 		return 0;
 	
 	size_t memory = sizeof(struct ring_buffer);
-	memory += capacity * element_size;
+	memory += ring_buffer_capacity(rb) * sizeof(void *);
 	
 	ring_buffer_destroy(rb);
 	
@@ -105,41 +259,51 @@ MEMORY_BENCHMARK(ring_buffer_memory)
 BENCHMARK_SUITE_BEGIN("Event Processing")
 	/* Setup */
 	struct event_processor_config config = {0};
-	config.buffer_size = 10000;
-	config.worker_threads = 4;
+	config.ring_buffer_size = 10000;
+	config.thread_pool_size = 4;
 	config.rate_limit = 0; /* No rate limiting for benchmark */
-	
+
 	g_processor = event_processor_create(&config);
-	if (g_processor) {
-		event_processor_register_callback(g_processor, event_callback, NULL);
-		event_processor_start(g_processor);
-	}
-	
-	g_ring_buffer = ring_buffer_create(1000, sizeof(int));
-	
+	if (g_processor)
+		event_processor_register_handler(g_processor, event_callback, NULL);
+
+	g_ring_buffer = ring_buffer_create(1000);
+	g_mpmc_ring = ring_buffer_create_mpmc(1024);
+
 	/* Run benchmarks */
 	RUN_BENCHMARK(event_creation);
 	RUN_BENCHMARK(event_copy);
-	
+
 	if (g_processor) {
 		RUN_THROUGHPUT_BENCHMARK(event_submission);
 		printf("Events processed: %lu\n", g_events_processed);
 	}
-	
+
 	if (g_ring_buffer) {
 		RUN_THROUGHPUT_BENCHMARK(ring_buffer_ops);
+		RUN_THROUGHPUT_BENCHMARK(ring_buffer_bulk_ops);
 	}
-	
+
+	if (g_mpmc_ring) {
+		RUN_THROUGHPUT_BENCHMARK(mpmc_ring_ops);
+		RUN_THROUGHPUT_BENCHMARK(mpmc_ring_bulk_ops);
+		run_mpmc_contended();
+	}
+
+	run_rate_limiter_scaling(false);
+	run_rate_limiter_scaling(true);
+
 	RUN_MEMORY_BENCHMARK(event_processor_memory);
 	RUN_MEMORY_BENCHMARK(ring_buffer_memory);
-	
+
 	/* Cleanup */
-	if (g_processor) {
-		event_processor_stop(g_processor);
-		event_processor_destroy(g_processor);
-	}
-	
+	if (g_processor)
+		event_processor_destroy(g_processor, true);
+
 	if (g_ring_buffer) {
 		ring_buffer_destroy(g_ring_buffer);
 	}
+
+	if (g_mpmc_ring)
+		ring_buffer_destroy(g_mpmc_ring);
 BENCHMARK_SUITE_END()
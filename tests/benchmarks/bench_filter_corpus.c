@@ -0,0 +1,512 @@
+/* bench_filter_corpus.c - Filter engine over realistic filter sets
+ *
+ * Builds corpora of 10, 100 and 1000 filters as operators write them:
+ * interface globs, exact interfaces with message types, numeric ranges,
+ * address regexes, service port sets and nested AND/OR/NOT. Each corpus
+ * is run over a set of events parsed from nl_traffic_gen traffic and
+ * measured for
+ *   - parse and compile time per filter
+ *   - heap taken per parsed and per compiled filter
+ *   - evaluation cost per event of the whole set, interpreted,
+ *     optimized, JIT compiled and shared through one filter_manager DAG
+ *   - regex cache hits, misses, compiles and evictions
+ * so JIT and decision tree work can be judged on filter sets of the
+ * size and shape deployments have.
+ *
+ * Usage:
+ *   bench_filter_corpus [-n sizes] [-e events] [-p passes] [-c cache] [-f file]
+ *
+ *   -n  Comma separated corpus sizes (default 10,100,1000)
+ *   -e  Events in the event set (default 4096)
+ *   -p  Passes over the event set per measurement (default 4)
+ *   -c  Regex cache entries of the evaluation context (default 64)
+ *   -f  Filters to use instead of generated ones, one per line; a corpus
+ *       size takes the first that many, repeating them if needed
+ *
+ * Globs are written as anchored regexes, the filter language has no
+ * glob operator.
+ */
+
+#include "benchmark_framework.h"
+#include <errno.h>
+#include <malloc.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "nl_traffic_gen.h"
+#include "event_processor.h"
+#include "nlmon_nl_event.h"
+#include "nlmon_nl_route.h"
+#include "filter_parser.h"
+#include "filter_compiler.h"
+#include "filter_eval.h"
+#include "filter_jit.h"
+#include "filter_manager.h"
+#include "filter_regex.h"
+
+#define USAGE "Usage: %s [-n sizes] [-e events] [-p passes] [-c cache] [-f file]\n"
+
+#define MAX_SIZES 16
+#define MAX_EXPRESSION 256
+#define CORPUS_SEED 0x5eed
+
+/* A corpus and its compiled forms */
+struct corpus {
+	size_t count;
+	char **expressions;
+	struct filter_expr **asts;
+	struct filter_bytecode **plain;
+	struct filter_bytecode **optimized;
+	struct filter_bytecode **jit;
+	size_t jit_compiled;
+};
+
+struct event_set {
+	struct nlmon_event *events;
+	size_t count;
+};
+
+static uint64_t g_rng = CORPUS_SEED;
+
+static uint32_t rng_pick(uint32_t n)
+{
+	g_rng ^= g_rng << 13;
+	g_rng ^= g_rng >> 7;
+	g_rng ^= g_rng << 17;
+	return (uint32_t)(g_rng % n);
+}
+
+/* One filter of the kinds operators write, parameters drawn at random */
+static void generate_filter(char *buf, size_t size)
+{
+	switch (rng_pick(12)) {
+	case 0:     /* Interface glob nlgen00N? */
+		snprintf(buf, size, "interface =~ \"^nlgen00%u[0-9]$\"", rng_pick(2));
+		break;
+	case 1:
+		snprintf(buf, size, "interface == \"nlgen%04u\" AND netlink.msg_type IN [16, 17]",
+		         1 + rng_pick(16));
+		break;
+	case 2: {
+		uint32_t low = 576 + rng_pick(1000);
+		
+		snprintf(buf, size, "netlink.link.mtu >= %u AND netlink.link.mtu <= %u",
+		         low, low + rng_pick(8000));
+		break;
+	}
+	case 3: {
+		static const unsigned int ports[] = { 22, 53, 80, 123, 443, 8080 };
+		
+		snprintf(buf, size, "netlink.protocol == 12 AND netlink.ct.dst_port IN [%u, %u] AND "
+		         "netlink.ct.protocol == %u", ports[rng_pick(6)], ports[rng_pick(6)],
+		         rng_pick(2) ? 6 : 17);
+		break;
+	}
+	case 4:     /* Source subnet, one regex per /24 */
+		snprintf(buf, size, "netlink.ct.src_addr =~ \"^10[.]128[.]%u[.]\"", rng_pick(256));
+		break;
+	case 5:
+		snprintf(buf, size, "(netlink.route.priority > %u OR netlink.route.protocol == 4) AND "
+		         "NOT netlink.route.dst =~ \"^172[.]16[.]%u[.]\"", 100 + rng_pick(8),
+		         rng_pick(16));
+		break;
+	case 6:
+		snprintf(buf, size, "netlink.neigh.state IN [2, 4, 8] AND netlink.neigh.ifindex <= %u",
+		         1 + rng_pick(16));
+		break;
+	case 7:
+		snprintf(buf, size, "netlink.addr.label =~ \"^nlgen000[%u-9]$\" OR "
+		         "netlink.addr.prefixlen < %u", rng_pick(10), 8 + rng_pick(24));
+		break;
+	case 8:
+		snprintf(buf, size, "netlink.protocol == 16 AND (netlink.nl80211.freq >= %u OR "
+		         "netlink.nl80211.iftype == %u)", rng_pick(2) ? 5000 : 2400, 1 + rng_pick(3));
+		break;
+	case 9:
+		snprintf(buf, size, "netlink.protocol == 12 AND NOT (netlink.ct.tcp_state IN [7, 8]) AND "
+		         "(netlink.ct.dst_addr == \"203.0.113.%u\" OR netlink.ct.src_port < %u)",
+		         1 + rng_pick(16), 32768 + rng_pick(16384));
+		break;
+	case 10:
+		snprintf(buf, size, "NOT interface =~ \"^(lo|docker|veth|nlgen00%u)\" AND "
+		         "netlink.msg_type == %u", rng_pick(2), 16 + 4 * rng_pick(4));
+		break;
+	default:
+		snprintf(buf, size, "netlink.msg_type == 16 OR netlink.msg_type == 20 OR "
+		         "(netlink.msg_type == 24 AND netlink.route.oif == %u)", 1 + rng_pick(16));
+		break;
+	}
+}
+
+static char **load_expressions(const char *path, size_t *count)
+{
+	char line[MAX_EXPRESSION * 4], **list = NULL;
+	size_t n = 0, capacity = 0;
+	FILE *f = fopen(path, "r");
+	
+	if (!f)
+		return NULL;
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (!line[0] || line[0] == '#')
+			continue;
+		if (n == capacity) {
+			char **grown;
+			
+			capacity = capacity ? capacity * 2 : 64;
+			grown = realloc(list, capacity * sizeof(*list));
+			if (!grown)
+				break;
+			list = grown;
+		}
+		list[n] = strdup(line);
+		if (list[n])
+			n++;
+	}
+	fclose(f);
+	*count = n;
+	return list;
+}
+
+/* Heap in use, to tell what building a corpus took */
+static size_t heap_in_use(void)
+{
+	struct mallinfo2 info = mallinfo2();
+	
+	return info.uordblks + info.hblkhd;
+}
+
+/* Interface of an event from its index, as the monitored host names them */
+static void name_interface(struct nlmon_event *evt)
+{
+	int ifindex = 0;
+	
+	if (evt->interface[0] || evt->netlink.protocol != NETLINK_ROUTE || !evt->netlink.data.generic)
+		return;
+	
+	switch (evt->netlink.msg_type) {
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		ifindex = evt->netlink.data.addr->ifindex;
+		break;
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE:
+		ifindex = evt->netlink.data.route->oif;
+		break;
+	case RTM_NEWNEIGH:
+	case RTM_DELNEIGH:
+		ifindex = evt->netlink.data.neigh->ifindex;
+		break;
+	}
+	if (ifindex > 0)
+		snprintf(evt->interface, sizeof(evt->interface), "nlgen%04d", ifindex % 10000);
+}
+
+static int build_events(struct event_set *set, size_t count)
+{
+	static uint8_t buf[NL_GEN_MAX_MSG] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nl_gen gen;
+	enum nl_gen_kind kind;
+	
+	if (nl_gen_init(&gen, NULL) < 0)
+		return -1;
+	set->events = calloc(count, sizeof(*set->events));
+	if (!set->events)
+		return -1;
+	
+	while (set->count < count) {
+		struct nlmon_event *evt = &set->events[set->count];
+		
+		if (!nl_gen_next(&gen, buf, sizeof(buf), &kind))
+			return -1;
+		if (nlmon_nl_parse_message((struct nlmsghdr *)buf, evt, nl_gen_protocol(kind)) < 0) {
+			free(evt->netlink.data.generic);
+			continue;
+		}
+		/* The raw message is only valid while buf holds it */
+		evt->raw_msg = NULL;
+		evt->raw_msg_len = 0;
+		name_interface(evt);
+		set->count++;
+	}
+	return 0;
+}
+
+static void free_events(struct event_set *set)
+{
+	for (size_t i = 0; i < set->count; i++)
+		free(set->events[i].netlink.data.generic);
+	free(set->events);
+}
+
+static void corpus_free(struct corpus *c)
+{
+	for (size_t i = 0; i < c->count; i++) {
+		if (c->jit && c->jit[i])
+			filter_bytecode_free(c->jit[i]);
+		if (c->optimized && c->optimized[i])
+			filter_bytecode_free(c->optimized[i]);
+		if (c->plain && c->plain[i])
+			filter_bytecode_free(c->plain[i]);
+		if (c->asts && c->asts[i])
+			filter_expr_free(c->asts[i]);
+	}
+	free(c->jit);
+	free(c->optimized);
+	free(c->plain);
+	free(c->asts);
+	free(c->expressions);
+}
+
+/* Run @passes over the events, returning ns per event and the matches */
+static double eval_set(struct filter_bytecode **filters, size_t count, struct event_set *set,
+                       unsigned int passes, struct filter_eval_context *ctx, uint64_t *matches)
+{
+	uint64_t start = benchmark_get_time_ns();
+	
+	*matches = 0;
+	for (unsigned int p = 0; p < passes; p++) {
+		for (size_t e = 0; e < set->count; e++) {
+			for (size_t f = 0; f < count; f++)
+				*matches += filter_eval(filters[f], &set->events[e], ctx);
+		}
+	}
+	return (double)(benchmark_get_time_ns() - start) / ((double)passes * set->count);
+}
+
+static double eval_manager(struct filter_manager *mgr, struct event_set *set,
+                           unsigned int passes, uint64_t *matches)
+{
+	uint64_t start = benchmark_get_time_ns();
+	
+	*matches = 0;
+	for (unsigned int p = 0; p < passes; p++) {
+		for (size_t e = 0; e < set->count; e++)
+			*matches += filter_manager_eval_all(mgr, &set->events[e], NULL, 0);
+	}
+	return (double)(benchmark_get_time_ns() - start) / ((double)passes * set->count);
+}
+
+static void print_regex_stats(const char *label, struct filter_eval_context *ctx)
+{
+	struct filter_regex_stats stats;
+	uint64_t lookups;
+	
+	filter_eval_regex_stats(ctx, &stats);
+	lookups = stats.hits + stats.misses;
+	printf("  Regex cache (%s): %llu lookups, %.1f%% hits, %llu compiles, %llu evictions, "
+	       "%zu/%zu entries\n", label, (unsigned long long)lookups,
+	       lookups ? 100.0 * stats.hits / lookups : 0.0, (unsigned long long)stats.compiles,
+	       (unsigned long long)stats.evictions, stats.entries, stats.capacity);
+}
+
+static int run_corpus(size_t size, char **source, size_t source_count, struct event_set *set,
+                      unsigned int passes, size_t cache_entries)
+{
+	struct corpus c = { .count = size };
+	struct filter_eval_context *ctx = NULL;
+	struct filter_manager *mgr = NULL;
+	char expression[MAX_EXPRESSION];
+	size_t heap, ast_bytes, bytecode_bytes, regex_bytes, i;
+	uint64_t start, parse_ns, compile_ns, matches, reference;
+	double cold, ns;
+	int ret = -1;
+	
+	c.expressions = calloc(size, sizeof(*c.expressions));
+	c.asts = calloc(size, sizeof(*c.asts));
+	c.plain = calloc(size, sizeof(*c.plain));
+	c.optimized = calloc(size, sizeof(*c.optimized));
+	c.jit = calloc(size, sizeof(*c.jit));
+	if (!c.expressions || !c.asts || !c.plain || !c.optimized || !c.jit)
+		goto out;
+	
+	/* The same corpus for a size on every run */
+	g_rng = CORPUS_SEED;
+	for (i = 0; i < size; i++) {
+		if (source) {
+			c.expressions[i] = strdup(source[i % source_count]);
+		} else {
+			generate_filter(expression, sizeof(expression));
+			c.expressions[i] = strdup(expression);
+		}
+		if (!c.expressions[i])
+			goto out;
+	}
+	
+	heap = heap_in_use();
+	start = benchmark_get_time_ns();
+	for (i = 0; i < size; i++) {
+		c.asts[i] = filter_parse(c.expressions[i]);
+		if (!c.asts[i]) {
+			fprintf(stderr, "Invalid filter: %s\n", c.expressions[i]);
+			goto out;
+		}
+	}
+	parse_ns = benchmark_get_time_ns() - start;
+	ast_bytes = heap_in_use() - heap;
+	
+	heap = heap_in_use();
+	start = benchmark_get_time_ns();
+	for (i = 0; i < size; i++) {
+		c.plain[i] = filter_compile(c.asts[i]);
+		if (!c.plain[i]) {
+			fprintf(stderr, "Failed to compile: %s\n", c.expressions[i]);
+			goto out;
+		}
+	}
+	compile_ns = benchmark_get_time_ns() - start;
+	bytecode_bytes = heap_in_use() - heap;
+	
+	for (i = 0; i < size; i++) {
+		c.optimized[i] = filter_compile(c.asts[i]);
+		c.jit[i] = filter_compile(c.asts[i]);
+		if (!c.optimized[i] || !c.jit[i])
+			goto out;
+		filter_bytecode_optimize(c.optimized[i]);
+		filter_bytecode_optimize(c.jit[i]);
+		if (filter_jit_compile(c.jit[i]))
+			c.jit_compiled++;
+	}
+	
+	ctx = filter_eval_context_create();
+	if (!ctx || !filter_eval_set_regex_cache_size(ctx, cache_entries))
+		goto out;
+	
+	printf("\n=== Corpus of %zu filters, %zu events ===\n", size, set->count);
+	printf("  Parse:           %8.0f ns/filter, %6zu bytes/filter\n",
+	       (double)parse_ns / size, ast_bytes / size);
+	printf("  Compile:         %8.0f ns/filter, %6zu bytes/filter\n",
+	       (double)compile_ns / size, bytecode_bytes / size);
+	
+	/*
+	 * The first pass compiles the patterns into the shared regex store,
+	 * emptied first as no context of an earlier corpus is left
+	 */
+	filter_regex_cleanup();
+	heap = heap_in_use();
+	cold = eval_set(c.plain, size, set, 1, ctx, &reference);
+	regex_bytes = heap_in_use() - heap;
+	print_regex_stats("first pass", ctx);
+	printf("  Regex store:     %6zu bytes/filter after the first pass\n", regex_bytes / size);
+	
+	filter_eval_reset_stats(ctx);
+	ns = eval_set(c.plain, size, set, passes, ctx, &matches);
+	print_regex_stats("warm", ctx);
+	printf("  %-16s %9.0f ns/event, %6.1f ns/filter (first pass %.0f ns/event), "
+	       "%.2f matches/event\n", "Interpreted:", ns, ns / size, cold,
+	       (double)reference / set->count);
+	
+	ns = eval_set(c.optimized, size, set, passes, ctx, &matches);
+	printf("  %-16s %9.0f ns/event, %6.1f ns/filter\n", "Optimized:", ns, ns / size);
+	if (matches != reference * passes)
+		printf("  WARNING: optimized filters matched %llu events, not %llu\n",
+		       (unsigned long long)matches, (unsigned long long)(reference * passes));
+	
+	if (c.jit_compiled) {
+		ns = eval_set(c.jit, size, set, passes, ctx, &matches);
+		printf("  %-16s %9.0f ns/event, %6.1f ns/filter (%zu of %zu compiled)\n", "JIT:",
+		       ns, ns / size, c.jit_compiled, size);
+		if (matches != reference * passes)
+			printf("  WARNING: JIT filters matched %llu events, not %llu\n",
+			       (unsigned long long)matches, (unsigned long long)(reference * passes));
+	} else {
+		printf("  %-16s unavailable\n", "JIT:");
+	}
+	
+	mgr = filter_manager_create(NULL);
+	if (!mgr)
+		goto out;
+	for (i = 0; i < size; i++) {
+		char name[32];
+		
+		snprintf(name, sizeof(name), "corpus%zu", i);
+		if (!filter_manager_add(mgr, name, c.expressions[i], NULL))
+			goto out;
+	}
+	filter_manager_set_shared(mgr, true);
+	ns = eval_manager(mgr, set, passes, &matches);
+	printf("  %-16s %9.0f ns/event, %6.1f ns/filter\n", "Shared DAG:", ns, ns / size);
+	if (matches != reference * passes)
+		printf("  WARNING: the DAG matched %llu events, not %llu\n",
+		       (unsigned long long)matches, (unsigned long long)(reference * passes));
+	ret = 0;
+	
+out:
+	filter_manager_destroy(mgr);
+	filter_eval_context_destroy(ctx);
+	corpus_free(&c);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	size_t sizes[MAX_SIZES] = { 10, 100, 1000 }, nsizes = 3, events = 4096;
+	size_t cache_entries = FILTER_EVAL_REGEX_CACHE_DEFAULT, source_count = 0;
+	unsigned int passes = 4;
+	struct event_set set = { 0 };
+	char **source = NULL;
+	int opt, ret = 0;
+	
+	while ((opt = getopt(argc, argv, "n:e:p:c:f:")) != -1) {
+		switch (opt) {
+		case 'n': {
+			char *p = optarg, *end;
+			
+			for (nsizes = 0; *p && nsizes < MAX_SIZES; p = *end ? end + 1 : end) {
+				sizes[nsizes] = strtoul(p, &end, 10);
+				if (!sizes[nsizes] || (*end && *end != ','))
+					goto usage;
+				nsizes++;
+			}
+			break;
+		}
+		case 'e':
+			events = strtoul(optarg, NULL, 10);
+			break;
+		case 'p':
+			passes = strtoul(optarg, NULL, 10);
+			break;
+		case 'c':
+			cache_entries = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			source = load_expressions(optarg, &source_count);
+			if (!source || !source_count) {
+				fprintf(stderr, "%s: %s\n", optarg, source ? "no filters" : strerror(errno));
+				return 1;
+			}
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc || !nsizes || !events || !passes || !cache_entries)
+		goto usage;
+	
+	if (build_events(&set, events) < 0) {
+		fprintf(stderr, "Failed to build the event set\n");
+		return 1;
+	}
+	
+	printf("=== Filter corpus: %zu events, %u passes, %zu regex cache entries, JIT %s ===\n",
+	       set.count, passes, cache_entries, filter_jit_available() ? "available" : "unavailable");
+	
+	for (size_t i = 0; i < nsizes; i++) {
+		if (run_corpus(sizes[i], source, source_count, &set, passes, cache_entries) < 0)
+			ret = 1;
+	}
+	
+	free_events(&set);
+	for (size_t i = 0; i < source_count; i++)
+		free(source[i]);
+	free(source);
+	filter_regex_cleanup();
+	return ret;
+	
+usage:
+	fprintf(stderr, USAGE, argv[0]);
+	return 2;
+}
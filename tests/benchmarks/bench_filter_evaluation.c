@@ -4,37 +4,54 @@
 #include "filter_parser.h"
 #include "filter_compiler.h"
 #include "filter_eval.h"
+#include "filter_jit.h"
+#include "filter_manager.h"
 #include "event_processor.h"
 #include <string.h>
 
 static struct filter_bytecode *g_simple_filter = NULL;
 static struct filter_bytecode *g_complex_filter = NULL;
+static struct filter_bytecode *g_complex_jit = NULL;
+static struct filter_bytecode *g_complex_opt = NULL;
 static struct nlmon_event g_test_event;
+static struct filter_eval_context *g_eval_ctx = NULL;
+static struct filter_manager *g_manager = NULL;
+static struct filter_manager *g_manager_shared = NULL;
+static struct filter_manager *g_literals = NULL;
+static struct filter_manager *g_literals_shared = NULL;
+
+/* Filters per manager, one per interface sharing message type predicates */
+#define MANAGER_FILTERS 32
+
+/* Events of one dispatch batch, with varying fields */
+#define BATCH_EVENTS EVENT_PROCESSOR_MAX_BATCH
+static struct nlmon_event g_batch_events[BATCH_EVENTS];
+static struct nlmon_event *g_batch[BATCH_EVENTS];
 
 BENCHMARK(filter_parse, 10000)
 {
-	struct filter_ast *ast = filter_parse("interface == \"eth0\"");
+	struct filter_expr *ast = filter_parse("interface == \"eth0\"");
 	if (ast) {
-		filter_ast_free(ast);
+		filter_expr_free(ast);
 	}
 }
 
 BENCHMARK(filter_compile, 10000)
 {
-	struct filter_ast *ast = filter_parse("interface == \"eth0\"");
+	struct filter_expr *ast = filter_parse("interface == \"eth0\"");
 	if (ast) {
 		struct filter_bytecode *bc = filter_compile(ast);
 		if (bc) {
 			filter_bytecode_free(bc);
 		}
-		filter_ast_free(ast);
+		filter_expr_free(ast);
 	}
 }
 
 BENCHMARK(filter_eval_simple, 1000000)
 {
 	if (g_simple_filter) {
-		filter_eval(g_simple_filter, &g_test_event);
+		filter_eval(g_simple_filter, &g_test_event, NULL);
 	}
 }
 
@@ -43,29 +60,184 @@ BENCHMARK(filter_eval_pattern, 1000000)
 	static struct filter_bytecode *pattern_filter = NULL;
 	
 	if (!pattern_filter) {
-		struct filter_ast *ast = filter_parse("interface =~ \"eth.*\"");
+		struct filter_expr *ast = filter_parse("interface =~ \"eth.*\"");
 		if (ast) {
 			pattern_filter = filter_compile(ast);
-			filter_ast_free(ast);
+			filter_expr_free(ast);
 		}
 	}
 	
 	if (pattern_filter) {
-		filter_eval(pattern_filter, &g_test_event);
+		filter_eval(pattern_filter, &g_test_event, NULL);
+	}
+}
+
+/* A regex without operators runs as a substring search */
+BENCHMARK(filter_eval_literal, 1000000)
+{
+	static struct filter_bytecode *literal_filter = NULL;
+	
+	if (!literal_filter) {
+		struct filter_expr *ast = filter_parse("interface =~ \"th0\"");
+		if (ast) {
+			literal_filter = filter_compile(ast);
+			filter_expr_free(ast);
+		}
+	}
+	
+	if (literal_filter) {
+		filter_eval(literal_filter, &g_test_event, g_eval_ctx);
 	}
 }
 
 BENCHMARK(filter_eval_complex, 100000)
 {
 	if (g_complex_filter) {
-		filter_eval(g_complex_filter, &g_test_event);
+		filter_eval(g_complex_filter, &g_test_event, NULL);
+	}
+}
+
+/* With a reused context string fields are borrowed and nothing allocates */
+BENCHMARK(filter_eval_simple_ctx, 1000000)
+{
+	if (g_simple_filter) {
+		filter_eval(g_simple_filter, &g_test_event, g_eval_ctx);
+	}
+}
+
+BENCHMARK(filter_eval_complex_ctx, 100000)
+{
+	if (g_complex_filter) {
+		filter_eval(g_complex_filter, &g_test_event, g_eval_ctx);
 	}
 }
 
+/* The same filter with superinstructions */
+BENCHMARK(filter_eval_complex_opt, 100000)
+{
+	if (g_complex_opt) {
+		filter_eval(g_complex_opt, &g_test_event, g_eval_ctx);
+	}
+}
+
+/* One batch event by event, and all of it at once */
+BENCHMARK(filter_eval_batch_loop, 10000)
+{
+	if (g_complex_opt) {
+		for (int i = 0; i < BATCH_EVENTS; i++)
+			filter_eval(g_complex_opt, g_batch[i], g_eval_ctx);
+	}
+}
+
+BENCHMARK(filter_eval_batch, 10000)
+{
+	uint64_t matches[(BATCH_EVENTS + 63) / 64];
+	
+	if (g_complex_opt) {
+		filter_eval_batch(g_complex_opt, g_batch, BATCH_EVENTS, g_eval_ctx, matches);
+	}
+}
+
+/* Instructions the interpreter dispatches for one evaluation */
+static void print_dispatches(const char *name, struct filter_bytecode *bc)
+{
+	uint64_t count, total = 0;
+	
+	if (!bc)
+		return;
+	
+	filter_eval_reset_stats(g_eval_ctx);
+	filter_eval(bc, &g_test_event, g_eval_ctx);
+	for (int op = 0; op <= OP_FIELD_IN_SET; op++) {
+		filter_eval_opcode_stats(g_eval_ctx, op, &count, NULL);
+		total += count;
+	}
+	
+	printf("%s: %zu instructions, %lu dispatches per evaluation\n",
+	       name, bc->instruction_count, total);
+}
+
+/* The same filter run as native code */
+BENCHMARK(filter_eval_complex_jit, 100000)
+{
+	if (g_complex_jit) {
+		filter_eval(g_complex_jit, &g_test_event, g_eval_ctx);
+	}
+}
+
+/* All filters of a manager, one by one and through the shared DAG */
+BENCHMARK(filter_manager_eval_all, 10000)
+{
+	if (g_manager) {
+		filter_manager_eval_all(g_manager, &g_test_event, NULL, 0);
+	}
+}
+
+BENCHMARK(filter_manager_eval_all_shared, 10000)
+{
+	if (g_manager_shared) {
+		filter_manager_eval_all(g_manager_shared, &g_test_event, NULL, 0);
+	}
+}
+
+/* Substring filters, one automaton scan per event when shared */
+BENCHMARK(filter_manager_literals, 10000)
+{
+	if (g_literals) {
+		filter_manager_eval_all(g_literals, &g_test_event, NULL, 0);
+	}
+}
+
+BENCHMARK(filter_manager_literals_shared, 10000)
+{
+	if (g_literals_shared) {
+		filter_manager_eval_all(g_literals_shared, &g_test_event, NULL, 0);
+	}
+}
+
+static struct filter_manager *create_literal_manager(bool shared)
+{
+	struct filter_manager *mgr = filter_manager_create(NULL);
+	char name[32], expression[128];
+	
+	if (!mgr)
+		return NULL;
+	
+	for (int i = 0; i < MANAGER_FILTERS; i++) {
+		snprintf(name, sizeof(name), "literal%d", i);
+		snprintf(expression, sizeof(expression), "interface =~ \"%s%d\"",
+		         i % 2 ? "veth" : "th", i);
+		filter_manager_add(mgr, name, expression, NULL);
+	}
+	
+	filter_manager_set_shared(mgr, shared);
+	return mgr;
+}
+
+static struct filter_manager *create_manager(bool shared)
+{
+	struct filter_manager *mgr = filter_manager_create(NULL);
+	char name[32], expression[128];
+	
+	if (!mgr)
+		return NULL;
+	
+	for (int i = 0; i < MANAGER_FILTERS; i++) {
+		snprintf(name, sizeof(name), "filter%d", i);
+		snprintf(expression, sizeof(expression),
+		         "interface == \"eth%d\" AND (message_type == 16 OR message_type IN [%d, 17])",
+		         i, 20 + i);
+		filter_manager_add(mgr, name, expression, NULL);
+	}
+	
+	filter_manager_set_shared(mgr, shared);
+	return mgr;
+}
+
 THROUGHPUT_BENCHMARK(filter_evaluation_throughput, 5.0)
 {
 	if (g_simple_filter) {
-		filter_eval(g_simple_filter, &g_test_event);
+		filter_eval(g_simple_filter, &g_test_event, g_eval_ctx);
 		return 1;
 	}
 	return 0;
@@ -73,7 +245,7 @@ THROUGHPUT_BENCHMARK(filter_evaluation_throughput, 5.0)
 
 MEMORY_BENCHMARK(filter_memory)
 {
-	struct filter_ast *ast;
+	struct filter_expr *ast;
 	struct filter_bytecode *bc;
 	size_t memory = 0;
 	
@@ -86,7 +258,7 @@ MEMORY_BENCHMARK(filter_memory)
 			memory += bc->instruction_count * sizeof(uint32_t);
 			filter_bytecode_free(bc);
 		}
-		filter_ast_free(ast);
+		filter_expr_free(ast);
 	}
 	
 	return memory;
@@ -98,27 +270,64 @@ BENCHMARK_SUITE_BEGIN("Filter Evaluation")
 	g_test_event.message_type = 16;
 	strncpy(g_test_event.interface, "eth0", sizeof(g_test_event.interface) - 1);
 	
+	g_eval_ctx = filter_eval_context_create();
+	
+	for (int i = 0; i < BATCH_EVENTS; i++) {
+		g_batch_events[i].message_type = 14 + i % 8;
+		snprintf(g_batch_events[i].interface, sizeof(g_batch_events[i].interface),
+		         i % 3 ? "eth%d" : "veth%d", i % 4);
+		g_batch[i] = &g_batch_events[i];
+	}
+	
 	/* Compile filters for benchmarks */
-	struct filter_ast *ast;
+	struct filter_expr *ast;
 	
 	ast = filter_parse("interface == \"eth0\"");
 	if (ast) {
 		g_simple_filter = filter_compile(ast);
-		filter_ast_free(ast);
+		filter_expr_free(ast);
 	}
 	
 	ast = filter_parse("(interface == \"eth0\" AND message_type == 16) OR (interface =~ \"veth.*\" AND message_type IN [16, 17])");
 	if (ast) {
 		g_complex_filter = filter_compile(ast);
-		filter_ast_free(ast);
+		g_complex_jit = filter_compile(ast);
+		g_complex_opt = filter_compile(ast);
+		if (g_complex_opt)
+			filter_bytecode_optimize(g_complex_opt);
+		if (g_complex_jit && !filter_jit_compile(g_complex_jit)) {
+			filter_bytecode_free(g_complex_jit);
+			g_complex_jit = NULL;
+		}
+		filter_expr_free(ast);
 	}
 	
+	g_manager = create_manager(false);
+	g_manager_shared = create_manager(true);
+	g_literals = create_literal_manager(false);
+	g_literals_shared = create_literal_manager(true);
+	
 	/* Run benchmarks */
 	RUN_BENCHMARK(filter_parse);
 	RUN_BENCHMARK(filter_compile);
 	RUN_BENCHMARK(filter_eval_simple);
 	RUN_BENCHMARK(filter_eval_pattern);
+	RUN_BENCHMARK(filter_eval_literal);
 	RUN_BENCHMARK(filter_eval_complex);
+	RUN_BENCHMARK(filter_eval_simple_ctx);
+	RUN_BENCHMARK(filter_eval_complex_ctx);
+	RUN_BENCHMARK(filter_eval_complex_opt);
+	RUN_BENCHMARK(filter_eval_complex_jit);
+	RUN_BENCHMARK(filter_eval_batch_loop);
+	RUN_BENCHMARK(filter_eval_batch);
+	RUN_BENCHMARK(filter_manager_eval_all);
+	RUN_BENCHMARK(filter_manager_eval_all_shared);
+	RUN_BENCHMARK(filter_manager_literals);
+	RUN_BENCHMARK(filter_manager_literals_shared);
+	
+	printf("\n");
+	print_dispatches("complex", g_complex_filter);
+	print_dispatches("complex optimized", g_complex_opt);
 	RUN_THROUGHPUT_BENCHMARK(filter_evaluation_throughput);
 	RUN_MEMORY_BENCHMARK(filter_memory);
 	
@@ -129,4 +338,15 @@ BENCHMARK_SUITE_BEGIN("Filter Evaluation")
 	if (g_complex_filter) {
 		filter_bytecode_free(g_complex_filter);
 	}
+	if (g_complex_jit) {
+		filter_bytecode_free(g_complex_jit);
+	}
+	if (g_complex_opt) {
+		filter_bytecode_free(g_complex_opt);
+	}
+	filter_manager_destroy(g_manager);
+	filter_manager_destroy(g_manager_shared);
+	filter_manager_destroy(g_literals);
+	filter_manager_destroy(g_literals_shared);
+	filter_eval_context_destroy(g_eval_ctx);
 BENCHMARK_SUITE_END()
@@ -0,0 +1,1001 @@
+/* bench_io.c - End-to-end throughput and latency of the I/O paths
+ *
+ * Drives the servers over loopback sockets and the exporters into a
+ * temporary directory, the way clients and the event path use them:
+ *
+ *   web        REST requests/s and latency against concurrent keep-alive
+ *              clients, for a route built per request and a cached
+ *              resource (needs ENABLE_WEB)
+ *   websocket  Broadcast fan-out to 1 to 256 subscribers: broadcasts and
+ *              deliveries per second, and broadcasts skipped for lagging
+ *              subscribers
+ *   scrape     Prometheus scrape time against the number of series, plain
+ *              and gzipped, with the response cache off
+ *   export     JSON, pcap and syslog exporter events/s against flush,
+ *              buffer, batch and compression settings
+ *
+ * Usage:
+ *   bench_io [-d seconds] [-c clients] [-s suites] [-o results]
+ *
+ *   -d  Length of each point (default 1)
+ *   -c  Most concurrent web clients and websocket subscribers (default 256)
+ *   -s  Comma separated suites: web, websocket, scrape, export
+ *       (default all)
+ *   -o  Append results to a file, one JSON object per point, for
+ *       tracking across builds
+ *
+ * Clients run in the same process on the same CPUs as the servers, so
+ * numbers compare builds and settings on one machine rather than give
+ * the capacity of a deployment.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "benchmark_framework.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "hdr_histogram.h"
+#include "websocket_server.h"
+#include "prometheus_exporter.h"
+#include "json_export.h"
+#include "pcap_export.h"
+#include "syslog_forwarder.h"
+#ifdef ENABLE_WEB
+#include "web_server.h"
+#endif
+
+#define USAGE "Usage: %s [-d seconds] [-c clients] [-s web,websocket,scrape,export] [-o results]\n"
+
+#define MAX_CLIENTS 1024
+
+/* Fixed ports, the web and websocket servers take no port 0 */
+#define WEB_PORT 19580
+#define WS_PORT 19581
+
+/* Broadcasts fit a 2 byte frame header, so deliveries are bytes / frame */
+#define WS_MESSAGE_SIZE 120
+#define WS_FRAME_SIZE (WS_MESSAGE_SIZE + 2)
+
+/* Most series the registry takes, leaving room for the built-in ones */
+#define MAX_SERIES 960
+
+/* Events written between checks of the clock */
+#define EXPORT_CHUNK 256
+
+enum io_suite {
+	SUITE_WEB,
+	SUITE_WEBSOCKET,
+	SUITE_SCRAPE,
+	SUITE_EXPORT,
+	SUITE_COUNT
+};
+
+static const char *const suite_names[SUITE_COUNT] = {
+	"web", "websocket", "scrape", "export"
+};
+
+static double seconds = 1;
+static unsigned int max_clients = 256;
+static FILE *out;
+
+static int parse_suites(const char *list, bool *enabled)
+{
+	char *copy = strdup(list), *save = NULL, *name;
+	int ret = 0;
+	
+	if (!copy)
+		return -1;
+	for (name = strtok_r(copy, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+		int s;
+	
+		for (s = 0; s < SUITE_COUNT; s++) {
+			if (strcmp(name, suite_names[s]) == 0)
+				break;
+		}
+		if (s == SUITE_COUNT) {
+			ret = -1;
+			break;
+		}
+		enabled[s] = true;
+	}
+	free(copy);
+	return ret;
+}
+
+/* Start a result line, the caller adds its fields and closes it */
+static bool result_begin(enum io_suite suite, const char *point)
+{
+	if (!out)
+		return false;
+	fprintf(out, "{\"benchmark\":\"io\",\"suite\":\"%s\",\"point\":\"%s\",\"time\":%lld,"
+	        "\"cpus\":%ld,\"seconds\":%.3f", suite_names[suite], point, (long long)time(NULL),
+	        sysconf(_SC_NPROCESSORS_ONLN), seconds);
+	return true;
+}
+
+/* HTTP over loopback */
+
+static int tcp_connect(uint16_t port)
+{
+	struct timeval tv = { .tv_sec = 5 };
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	int one = 1;
+	int fd;
+	
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* GET path on a keep-alive connection and read the whole response.
+ * Returns the body length, -1 on error or a status other than 200. */
+static ssize_t http_get(int fd, const char *path, const char *headers)
+{
+	char buf[16384], request[512];
+	size_t len = 0, header_len, body_len;
+	const char *end, *field;
+	ssize_t n;
+	
+	n = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: localhost\r\n"
+	             "Connection: keep-alive\r\n%s\r\n", path, headers ? headers : "");
+	if (send(fd, request, (size_t)n, MSG_NOSIGNAL) != n)
+		return -1;
+	
+	/* Headers, and whatever of the body came with them */
+	for (;;) {
+		n = recv(fd, buf + len, sizeof(buf) - 1 - len, 0);
+		if (n <= 0)
+			return -1;
+		len += (size_t)n;
+		buf[len] = '\0';
+		end = strstr(buf, "\r\n\r\n");
+		if (end)
+			break;
+		if (len == sizeof(buf) - 1)
+			return -1;
+	}
+	if (strncmp(buf, "HTTP/1.1 200", 12) != 0)
+		return -1;
+	
+	header_len = (size_t)(end + 4 - buf);
+	field = strcasestr(buf, "\r\nContent-Length:");
+	if (!field || field > end)
+		return -1;
+	body_len = strtoul(field + 17, NULL, 10);
+	
+	/* Read out the rest of the body */
+	for (size_t have = len - header_len; have < body_len; have += (size_t)n) {
+		size_t want = body_len - have;
+	
+		n = recv(fd, buf, want < sizeof(buf) ? want : sizeof(buf), 0);
+		if (n <= 0)
+			return -1;
+	}
+	return (ssize_t)body_len;
+}
+
+struct http_client {
+	pthread_t thread;
+	uint16_t port;
+	const char *path;
+	const char *headers;
+	uint64_t deadline;
+	uint64_t requests;
+	uint64_t errors;
+	uint64_t bytes;
+	struct hdr_histogram *latency;  /* Microseconds */
+};
+
+static void *http_client_thread(void *arg)
+{
+	struct http_client *client = arg;
+	int fd = tcp_connect(client->port);
+	
+	while (fd >= 0 && benchmark_get_time_ns() < client->deadline) {
+		uint64_t start = benchmark_get_time_ns();
+		ssize_t n = http_get(fd, client->path, client->headers);
+	
+		if (n < 0) {
+			/* The server may close a connection, take another one */
+			client->errors++;
+			close(fd);
+			fd = tcp_connect(client->port);
+			continue;
+		}
+		hdr_histogram_record(client->latency, (benchmark_get_time_ns() - start) / 1000.0);
+		client->requests++;
+		client->bytes += (uint64_t)n;
+	}
+	if (fd >= 0)
+		close(fd);
+	return NULL;
+}
+
+struct http_result {
+	double seconds;
+	uint64_t requests;
+	uint64_t errors;
+	uint64_t bytes;
+	double p50_us;
+	double p99_us;
+	double max_us;
+};
+
+/* Run clients on a path for the point's length */
+static int run_http(uint16_t port, const char *path, const char *headers,
+                    unsigned int count, struct http_result *r)
+{
+	struct http_client *clients = calloc(count, sizeof(*clients));
+	struct hdr_histogram *latency = hdr_histogram_create(HDR_HISTOGRAM_DEFAULT_SCHEMA);
+	uint64_t start = benchmark_get_time_ns();
+	unsigned int started = 0;
+	int ret = -1;
+	
+	memset(r, 0, sizeof(*r));
+	if (!clients || !latency)
+		goto out;
+	
+	for (; started < count; started++) {
+		struct http_client *client = &clients[started];
+	
+		client->port = port;
+		client->path = path;
+		client->headers = headers;
+		client->deadline = start + (uint64_t)(seconds * 1e9);
+		client->latency = hdr_histogram_create(HDR_HISTOGRAM_DEFAULT_SCHEMA);
+		if (!client->latency ||
+		    pthread_create(&client->thread, NULL, http_client_thread, client) != 0) {
+			hdr_histogram_destroy(client->latency);
+			break;
+		}
+	}
+	
+	for (unsigned int i = 0; i < started; i++) {
+		pthread_join(clients[i].thread, NULL);
+		r->requests += clients[i].requests;
+		r->errors += clients[i].errors;
+		r->bytes += clients[i].bytes;
+		hdr_histogram_merge(latency, clients[i].latency);
+		hdr_histogram_destroy(clients[i].latency);
+	}
+	r->seconds = (benchmark_get_time_ns() - start) / 1e9;
+	r->p50_us = hdr_histogram_quantile(latency, 0.5);
+	r->p99_us = hdr_histogram_quantile(latency, 0.99);
+	r->max_us = hdr_histogram_max(latency);
+	ret = started == count && r->requests ? 0 : -1;
+
+out:
+	hdr_histogram_destroy(latency);
+	free(clients);
+	return ret;
+}
+
+/* web: REST requests against concurrent clients */
+
+#ifdef ENABLE_WEB
+static void write_http_result(enum io_suite suite, const char *point, unsigned int clients,
+                              const struct http_result *r)
+{
+	if (!result_begin(suite, point))
+		return;
+	fprintf(out, ",\"clients\":%u,\"requests\":%llu,\"requests_per_sec\":%.0f,"
+	        "\"errors\":%llu,\"bytes_per_response\":%.0f,\"p50_us\":%.1f,\"p99_us\":%.1f,"
+	        "\"max_us\":%.1f}\n", clients, (unsigned long long)r->requests,
+	        r->requests / r->seconds, (unsigned long long)r->errors,
+	        r->requests ? (double)r->bytes / r->requests : 0.0, r->p50_us, r->p99_us,
+	        r->max_us);
+}
+
+/* About the size of /api/stats */
+static char stats_body[1024];
+
+static int stats_handler(void *cls, const char *url, const char *method,
+                         const char *version, const char *upload_data,
+                         size_t *upload_data_size, void **con_cls,
+                         char **response, size_t *response_len,
+                         const char **content_type)
+{
+	(void)cls; (void)url; (void)method; (void)version;
+	(void)upload_data; (void)upload_data_size; (void)con_cls;
+	
+	*response = strdup(stats_body);
+	if (!*response)
+		return -1;
+	*response_len = strlen(stats_body);
+	*content_type = "application/json";
+	return 0;
+}
+
+static uint64_t status_version(void *user_data)
+{
+	(void)user_data;
+	return 1;
+}
+
+static int status_build(void *user_data, char **body, size_t *len)
+{
+	(void)user_data;
+	*body = strdup(stats_body);
+	*len = strlen(stats_body);
+	return *body ? 0 : -1;
+}
+
+static int bench_web(void)
+{
+	static const char *const paths[] = { "/api/stats", "/api/status" };
+	struct web_server_config config = {
+		.port = WEB_PORT,
+		.max_connections = MAX_CLIENTS,
+		.thread_pool_size = 4,
+	};
+	struct web_server *server;
+	size_t len = 0;
+	int ret = 0;
+	
+	len += snprintf(stats_body + len, sizeof(stats_body) - len, "{\"events\":{");
+	for (int i = 0; i < 24 && len < sizeof(stats_body) - 64; i++)
+		len += snprintf(stats_body + len, sizeof(stats_body) - len,
+		                "%s\"counter_%02d\":%d", i ? "," : "", i, 1000003 * i);
+	snprintf(stats_body + len, sizeof(stats_body) - len, "}}");
+	
+	server = web_server_init(&config);
+	if (!server || web_server_register_route(server, paths[0], "GET", stats_handler, NULL) < 0 ||
+	    web_server_register_resource(server, paths[1], "application/json", status_version,
+	                                 status_build, NULL) < 0 ||
+	    web_server_start(server) < 0) {
+		fprintf(stderr, "web: cannot start the server on port %d\n", WEB_PORT);
+		if (server)
+			web_server_cleanup(server);
+		return -1;
+	}
+	
+	printf("\n%-14s %7s %12s %10s %10s %10s %7s\n", "web", "clients", "requests/s",
+	       "p50 us", "p99 us", "max us", "errors");
+	for (size_t p = 0; p < sizeof(paths) / sizeof(paths[0]); p++) {
+		for (unsigned int clients = 1; clients <= max_clients; clients *= 4) {
+			struct http_result r;
+	
+			if (run_http(WEB_PORT, paths[p], NULL, clients, &r) < 0) {
+				fprintf(stderr, "web: %s with %u clients failed\n", paths[p], clients);
+				ret = -1;
+				continue;
+			}
+			printf("%-14s %7u %12.0f %10.1f %10.1f %10.1f %7llu\n", paths[p], clients,
+			       r.requests / r.seconds, r.p50_us, r.p99_us, r.max_us,
+			       (unsigned long long)r.errors);
+			fflush(stdout);
+			write_http_result(SUITE_WEB, paths[p], clients, &r);
+		}
+	}
+	
+	web_server_stop(server);
+	web_server_cleanup(server);
+	return ret;
+}
+#else
+static int bench_web(void)
+{
+	printf("\nweb: built without ENABLE_WEB, skipped\n");
+	return 0;
+}
+#endif
+
+/* websocket: broadcast fan-out against subscriber count */
+
+/* Open a websocket without extensions, non-blocking once upgraded */
+static int ws_connect(uint16_t port)
+{
+	static const char request[] =
+		"GET /ws HTTP/1.1\r\n"
+		"Host: localhost\r\n"
+		"Upgrade: websocket\r\n"
+		"Connection: Upgrade\r\n"
+		"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+		"Sec-WebSocket-Version: 13\r\n"
+		"\r\n";
+	char response[512];
+	size_t len = 0;
+	int fd;
+	
+	fd = tcp_connect(port);
+	if (fd < 0)
+		return -1;
+	if (send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL) != (ssize_t)sizeof(request) - 1)
+		goto fail;
+	
+	/* Exactly the response headers, frames may follow */
+	while (len < sizeof(response) - 1) {
+		if (recv(fd, response + len, 1, 0) != 1)
+			goto fail;
+		response[++len] = '\0';
+		if (len >= 4 && strcmp(response + len - 4, "\r\n\r\n") == 0)
+			break;
+	}
+	if (strncmp(response, "HTTP/1.1 101", 12) != 0)
+		goto fail;
+	
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+struct ws_reader {
+	pthread_t thread;
+	int epfd;
+	_Atomic uint64_t bytes;
+	atomic_bool stop;
+};
+
+/* Drain every subscriber, counting what arrives */
+static void *ws_reader_thread(void *arg)
+{
+	struct ws_reader *reader = arg;
+	struct epoll_event events[64];
+	char buf[65536];
+	
+	while (!atomic_load(&reader->stop)) {
+		int n = epoll_wait(reader->epfd, events, 64, 10);
+	
+		for (int i = 0; i < n; i++) {
+			ssize_t got;
+	
+			while ((got = recv(events[i].data.fd, buf, sizeof(buf), 0)) > 0)
+				atomic_fetch_add(&reader->bytes, (uint64_t)got);
+		}
+	}
+	return NULL;
+}
+
+static bool wait_connections(struct websocket_server *server, int count)
+{
+	for (int i = 0; i < 500; i++) {
+		if (websocket_get_connection_count(server) == count)
+			return true;
+		usleep(10000);
+	}
+	return false;
+}
+
+static int bench_websocket(void)
+{
+	struct websocket_config config = {
+		.port = WS_PORT,
+		.threads = 2,
+		.slow_client = WS_SLOW_CLIENT_SKIP,
+		.compression = WS_COMPRESSION_OFF,
+	};
+	struct websocket_server *server;
+	struct ws_reader reader;
+	char message[WS_MESSAGE_SIZE];
+	int *fds, ret = 0;
+	
+	memset(message, 'x', sizeof(message));
+	memcpy(message, "{\"type\":\"event\"", 15);
+	
+	fds = calloc(max_clients, sizeof(*fds));
+	server = websocket_server_init(&config);
+	if (!fds || !server || websocket_server_start(server) != 0) {
+		fprintf(stderr, "websocket: cannot start the server on port %d\n", WS_PORT);
+		if (server)
+			websocket_server_cleanup(server);
+		free(fds);
+		return -1;
+	}
+	
+	printf("\n%-14s %11s %13s %14s %10s %9s\n", "websocket", "subscribers", "broadcasts/s",
+	       "deliveries/s", "skipped", "dropped");
+	for (unsigned int subs = 1; subs <= max_clients; subs *= 4) {
+		struct websocket_stats before, after;
+		uint64_t start, end, broadcasts = 0, last = 0;
+		unsigned int connected = 0;
+		double elapsed;
+	
+		memset(&reader, 0, sizeof(reader));
+		reader.epfd = epoll_create1(EPOLL_CLOEXEC);
+		for (; connected < subs; connected++) {
+			struct epoll_event ev = { .events = EPOLLIN };
+	
+			fds[connected] = ws_connect(WS_PORT);
+			if (fds[connected] < 0)
+				break;
+			ev.data.fd = fds[connected];
+			epoll_ctl(reader.epfd, EPOLL_CTL_ADD, fds[connected], &ev);
+		}
+		if (connected < subs || !wait_connections(server, (int)subs) ||
+		    pthread_create(&reader.thread, NULL, ws_reader_thread, &reader) != 0) {
+			fprintf(stderr, "websocket: cannot connect %u subscribers\n", subs);
+			ret = -1;
+			for (unsigned int i = 0; i < connected; i++)
+				close(fds[i]);
+			close(reader.epfd);
+			break;
+		}
+	
+		websocket_get_stats(server, &before);
+		start = benchmark_get_time_ns();
+		end = start + (uint64_t)(seconds * 1e9);
+		while (benchmark_get_time_ns() < end) {
+			for (int i = 0; i < 64; i++)
+				broadcasts += websocket_broadcast(server, message, sizeof(message)) == 0;
+		}
+	
+		/* Until what was queued is delivered */
+		for (int idle = 0; idle < 20; ) {
+			uint64_t bytes;
+	
+			usleep(10000);
+			bytes = atomic_load(&reader.bytes);
+			idle = bytes == last ? idle + 1 : 0;
+			last = bytes;
+		}
+		elapsed = (benchmark_get_time_ns() - start) / 1e9;
+		websocket_get_stats(server, &after);
+	
+		atomic_store(&reader.stop, true);
+		pthread_join(reader.thread, NULL);
+	
+		printf("%-14s %11u %13.0f %14.0f %10llu %9llu\n", "", subs,
+		       broadcasts / ((end - start) / 1e9), (double)(last / WS_FRAME_SIZE) / elapsed,
+		       (unsigned long long)(after.frames_skipped - before.frames_skipped),
+		       (unsigned long long)(after.clients_dropped - before.clients_dropped));
+		fflush(stdout);
+		if (result_begin(SUITE_WEBSOCKET, "broadcast"))
+			fprintf(out, ",\"subscribers\":%u,\"broadcasts_per_sec\":%.0f,"
+			        "\"deliveries_per_sec\":%.0f,\"skipped\":%llu,\"dropped\":%llu}\n", subs,
+			        broadcasts / ((end - start) / 1e9), (double)(last / WS_FRAME_SIZE) / elapsed,
+			        (unsigned long long)(after.frames_skipped - before.frames_skipped),
+			        (unsigned long long)(after.clients_dropped - before.clients_dropped));
+	
+		for (unsigned int i = 0; i < connected; i++)
+			close(fds[i]);
+		close(reader.epfd);
+		wait_connections(server, 0);
+	}
+	
+	websocket_server_stop(server);
+	websocket_server_cleanup(server);
+	free(fds);
+	return ret;
+}
+
+/* scrape: Prometheus scrape time against series count */
+
+static int bench_scrape(void)
+{
+	static const unsigned int series_counts[] = { 16, 128, 512, MAX_SERIES };
+	static const char *const encodings[] = { NULL, "Accept-Encoding: gzip\r\n" };
+	struct prometheus_exporter *exporter;
+	unsigned int registered = 0;
+	uint16_t port;
+	int ret = 0;
+	
+	exporter = prometheus_exporter_create(0, "/metrics");
+	if (!exporter) {
+		fprintf(stderr, "scrape: cannot start the exporter\n");
+		return -1;
+	}
+	port = prometheus_exporter_get_port(exporter);
+	
+	/* Every scrape generates its text, what the cache saves is the point */
+	prometheus_exporter_set_cache_interval(exporter, 0);
+	
+	printf("\n%-14s %7s %10s %10s %10s %12s\n", "scrape", "series", "scrapes/s", "p50 us",
+	       "p99 us", "bytes");
+	for (size_t c = 0; c < sizeof(series_counts) / sizeof(series_counts[0]); c++) {
+		/* Counters of one name by interface and type, with a histogram in eight */
+		for (; registered < series_counts[c]; registered++) {
+			struct prometheus_metric *metric;
+			char labels[64];
+			bool histogram = registered % 8 == 7;
+	
+			snprintf(labels, sizeof(labels), "interface=\"eth%u\",type=\"%s\"",
+			         registered / 4, (const char *[]){ "link", "addr", "route", "neigh" }[registered % 4]);
+			metric = prometheus_exporter_register(exporter,
+			                                      histogram ? "nlmon_bench_latency_seconds" :
+			                                      "nlmon_bench_events_total", labels,
+			                                      histogram ? METRIC_TYPE_HISTOGRAM :
+			                                      METRIC_TYPE_COUNTER);
+			if (!metric)
+				break;
+			if (histogram)
+				prometheus_metric_observe(metric, registered * 1e-5);
+			else
+				prometheus_metric_inc(metric, registered * 1000);
+		}
+		if (registered < series_counts[c]) {
+			fprintf(stderr, "scrape: registry full at %u series\n", registered);
+			ret = -1;
+			break;
+		}
+	
+		for (size_t e = 0; e < sizeof(encodings) / sizeof(encodings[0]); e++) {
+			const char *point = encodings[e] ? "gzip" : "plain";
+			struct http_result r;
+	
+			if (run_http(port, "/metrics", encodings[e], 1, &r) < 0) {
+				fprintf(stderr, "scrape: %u series %s failed\n", registered, point);
+				ret = -1;
+				continue;
+			}
+			printf("%-14s %7u %10.0f %10.1f %10.1f %12.0f\n", point, registered,
+			       r.requests / r.seconds, r.p50_us, r.p99_us, (double)r.bytes / r.requests);
+			fflush(stdout);
+			if (result_begin(SUITE_SCRAPE, point))
+				fprintf(out, ",\"series\":%u,\"scrapes_per_sec\":%.0f,\"p50_us\":%.1f,"
+				        "\"p99_us\":%.1f,\"bytes\":%.0f}\n", registered, r.requests / r.seconds,
+				        r.p50_us, r.p99_us, (double)r.bytes / r.requests);
+		}
+	}
+	
+	prometheus_exporter_destroy(exporter);
+	return ret;
+}
+
+/* export: exporter events/s against flush, buffer, batch and compression */
+
+static char tmpdir[] = "/tmp/bench_io.XXXXXX";
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	(void)st; (void)flag; (void)ftw;
+	return remove(path);
+}
+
+static void print_export(const char *exporter, const char *setting, uint64_t events,
+                         uint64_t bytes, double elapsed, uint32_t rotations)
+{
+	printf("%-14s %-22s %12.0f ", exporter, setting, events / elapsed);
+	if (bytes)
+		printf("%10.1f %9u\n", bytes / elapsed / (1024.0 * 1024.0), rotations);
+	else
+		printf("%10s %9s\n", "-", "-");
+	fflush(stdout);
+	if (result_begin(SUITE_EXPORT, exporter))
+		fprintf(out, ",\"setting\":\"%s\",\"events_per_sec\":%.0f,\"mb_per_sec\":%.2f,"
+		        "\"rotations\":%u}\n", setting, events / elapsed,
+		        bytes / elapsed / (1024.0 * 1024.0), rotations);
+}
+
+static int bench_json_export(void)
+{
+	static const unsigned int flush_every[] = { 1, 64, 0 };
+	char path[64], setting[32];
+	int ret = 0;
+	
+	for (int compress = 0; compress <= 1; compress++) {
+		for (size_t f = 0; f < sizeof(flush_every) / sizeof(flush_every[0]); f++) {
+			struct json_rotation_policy policy = {
+				.max_file_size = 8 * 1024 * 1024,
+				.max_rotations = 2,
+				.compress_rotated = compress,
+			};
+			struct json_event event = {
+				.event_type = "link",
+				.message_type = 16,
+				.message_type_str = "RTM_NEWLINK",
+				.interface = "eth0",
+				.namespace = "default",
+				.details = "{\"ifindex\":2,\"mtu\":1500,\"flags\":\"UP,RUNNING\"}",
+			};
+			struct json_exporter *exporter;
+			uint64_t start, end, events = 0, bytes = 0;
+			uint32_t rotations = 0;
+	
+			snprintf(path, sizeof(path), "%s/events.json", tmpdir);
+			exporter = json_exporter_create(path, JSON_FORMAT_COMPACT, true, &policy);
+			if (!exporter) {
+				ret = -1;
+				continue;
+			}
+	
+			start = benchmark_get_time_ns();
+			end = start + (uint64_t)(seconds * 1e9);
+			while (benchmark_get_time_ns() < end) {
+				for (int i = 0; i < EXPORT_CHUNK; i++, events++) {
+					event.sequence = events;
+					event.timestamp_sec = 1700000000 + events / 1000;
+					event.timestamp_usec = events % 1000 * 1000;
+					json_exporter_write_event(exporter, &event);
+					if (flush_every[f] && (events + 1) % flush_every[f] == 0)
+						json_exporter_flush(exporter);
+				}
+			}
+			json_exporter_flush(exporter);
+			json_exporter_get_stats(exporter, NULL, &bytes, NULL, &rotations);
+			json_exporter_destroy(exporter);
+	
+			if (flush_every[f])
+				snprintf(setting, sizeof(setting), "flush/%u%s", flush_every[f],
+				         compress ? " gzip" : "");
+			else
+				snprintf(setting, sizeof(setting), "flush/end%s", compress ? " gzip" : "");
+			print_export("json", setting, events, bytes,
+			             (benchmark_get_time_ns() - start) / 1e9, rotations);
+		}
+	}
+	return ret;
+}
+
+static int bench_pcap_export(void)
+{
+	static const size_t buffer_sizes[] = { 4096, 65536, PCAP_EXPORT_BUFFER_SIZE };
+	unsigned char packet[128];
+	char path[64], setting[32];
+	int ret = 0;
+	
+	/* A netlink message: header, ifinfomsg and attributes */
+	for (size_t i = 0; i < sizeof(packet); i++)
+		packet[i] = (unsigned char)(i * 7);
+	
+	for (int compress = 0; compress <= 1; compress++) {
+		for (size_t b = 0; b < sizeof(buffer_sizes) / sizeof(buffer_sizes[0]); b++) {
+			struct pcap_rotation_policy policy = {
+				.max_file_size = 16 * 1024 * 1024,
+				.max_rotations = 2,
+				.compress_rotated = compress,
+			};
+			struct pcap_export_options options = {
+				.format = PCAP_FORMAT_PCAP,
+				.buffer_size = buffer_sizes[b],
+			};
+			struct pcap_exporter *exporter;
+			uint64_t start, end, packets = 0, bytes = 0;
+			uint32_t rotations = 0;
+	
+			snprintf(path, sizeof(path), "%s/events", tmpdir);
+			exporter = pcap_exporter_create_with_options(path, &policy, &options);
+			if (!exporter) {
+				ret = -1;
+				continue;
+			}
+	
+			start = benchmark_get_time_ns();
+			end = start + (uint64_t)(seconds * 1e9);
+			while (benchmark_get_time_ns() < end) {
+				for (int i = 0; i < EXPORT_CHUNK; i++, packets++)
+					pcap_exporter_write_packet(exporter, packet, sizeof(packet));
+			}
+			pcap_exporter_flush(exporter);
+			pcap_exporter_get_stats(exporter, NULL, &bytes, NULL, &rotations);
+			pcap_exporter_destroy(exporter);
+	
+			snprintf(setting, sizeof(setting), "buffer/%zuK%s", buffer_sizes[b] / 1024,
+			         compress ? " gzip" : "");
+			print_export("pcap", setting, packets, bytes,
+			             (benchmark_get_time_ns() - start) / 1e9, rotations);
+		}
+	}
+	return ret;
+}
+
+struct udp_sink {
+	pthread_t thread;
+	int fd;
+	uint16_t port;
+	_Atomic uint64_t received;
+	atomic_bool stop;
+};
+
+static void *udp_sink_thread(void *arg)
+{
+	struct udp_sink *sink = arg;
+	char buf[2048];
+	
+	while (!atomic_load(&sink->stop)) {
+		if (recv(sink->fd, buf, sizeof(buf), 0) > 0)
+			atomic_fetch_add(&sink->received, 1);
+	}
+	return NULL;
+}
+
+static int udp_sink_start(struct udp_sink *sink)
+{
+	struct timeval tv = { .tv_usec = 50000 };
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t len = sizeof(addr);
+	int size = 8 * 1024 * 1024;
+	
+	memset(sink, 0, sizeof(*sink));
+	sink->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sink->fd < 0)
+		return -1;
+	setsockopt(sink->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(sink->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	if (bind(sink->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    getsockname(sink->fd, (struct sockaddr *)&addr, &len) < 0 ||
+	    pthread_create(&sink->thread, NULL, udp_sink_thread, sink) != 0) {
+		close(sink->fd);
+		return -1;
+	}
+	sink->port = ntohs(addr.sin_port);
+	return 0;
+}
+
+static void udp_sink_stop(struct udp_sink *sink)
+{
+	atomic_store(&sink->stop, true);
+	pthread_join(sink->thread, NULL);
+	close(sink->fd);
+}
+
+static int bench_syslog_export(void)
+{
+	static const unsigned int batch_sizes[] = { 1, SYSLOG_BATCH_DEFAULT, 128 };
+	struct syslog_message msg = {
+		.severity = SYSLOG_INFO,
+		.msg_id = "LINK",
+		.message = "RTM_NEWLINK eth0 ifindex=2 mtu=1500 flags=UP,RUNNING",
+	};
+	char setting[32];
+	int ret = 0;
+	
+	for (size_t b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); b++) {
+		struct syslog_config config = {
+			.server = "127.0.0.1",
+			.transport = SYSLOG_TRANSPORT_UDP,
+			.facility = SYSLOG_DAEMON,
+			.hostname = "bench",
+			.app_name = "nlmon",
+			.batch_size = batch_sizes[b],
+		};
+		struct syslog_forwarder *forwarder;
+		struct udp_sink sink;
+		uint64_t start, end, sent = 0, failed = 0, queued = 0;
+		double elapsed;
+	
+		if (udp_sink_start(&sink) < 0) {
+			ret = -1;
+			continue;
+		}
+		config.port = sink.port;
+		forwarder = syslog_forwarder_create(&config);
+		if (!forwarder) {
+			udp_sink_stop(&sink);
+			ret = -1;
+			continue;
+		}
+	
+		start = benchmark_get_time_ns();
+		end = start + (uint64_t)(seconds * 1e9);
+		while (benchmark_get_time_ns() < end) {
+			for (int i = 0; i < EXPORT_CHUNK; i++)
+				queued += syslog_forwarder_send(forwarder, &msg);
+		}
+		syslog_forwarder_flush(forwarder);
+		elapsed = (benchmark_get_time_ns() - start) / 1e9;
+		syslog_forwarder_get_stats(forwarder, &sent, &failed, NULL);
+		syslog_forwarder_destroy(forwarder);
+	
+		/* Let the sink catch up before counting what arrived */
+		usleep(100000);
+		udp_sink_stop(&sink);
+	
+		snprintf(setting, sizeof(setting), "batch/%u", batch_sizes[b]);
+		print_export("syslog", setting, sent, 0, elapsed, 0);
+		if (queued > sent || atomic_load(&sink.received) < sent)
+			printf("%-14s %-22s %llu queued, %llu failed, %llu received\n", "", "",
+			       (unsigned long long)queued, (unsigned long long)failed,
+			       (unsigned long long)atomic_load(&sink.received));
+	}
+	return ret;
+}
+
+static int bench_export(void)
+{
+	int ret = 0;
+	
+	if (!mkdtemp(tmpdir)) {
+		fprintf(stderr, "export: %s: %s\n", tmpdir, strerror(errno));
+		return -1;
+	}
+	
+	printf("\n%-14s %-22s %12s %10s %9s\n", "export", "setting", "events/s", "MB/s",
+	       "rotations");
+	ret |= bench_json_export();
+	ret |= bench_pcap_export();
+	ret |= bench_syslog_export();
+	
+	nftw(tmpdir, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	static int (*const suites[SUITE_COUNT])(void) = {
+		bench_web, bench_websocket, bench_scrape, bench_export
+	};
+	bool enabled[SUITE_COUNT] = { false };
+	const char *output = NULL;
+	int opt, ret = 0;
+	
+	while ((opt = getopt(argc, argv, "d:c:s:o:")) != -1) {
+		switch (opt) {
+		case 'd':
+			seconds = atof(optarg);
+			break;
+		case 'c':
+			max_clients = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			if (parse_suites(optarg, enabled) < 0) {
+				fprintf(stderr, "Unknown suite in %s\n", optarg);
+				return 2;
+			}
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			fprintf(stderr, USAGE, argv[0]);
+			return 2;
+		}
+	}
+	if (optind != argc || seconds <= 0 || !max_clients || max_clients > MAX_CLIENTS) {
+		fprintf(stderr, USAGE, argv[0]);
+		return 2;
+	}
+	if (!enabled[SUITE_WEB] && !enabled[SUITE_WEBSOCKET] && !enabled[SUITE_SCRAPE] &&
+	    !enabled[SUITE_EXPORT])
+		memset(enabled, true, sizeof(enabled));
+	
+	if (output) {
+		out = fopen(output, "a");
+		if (!out) {
+			fprintf(stderr, "%s: %s\n", output, strerror(errno));
+			return 1;
+		}
+	}
+	
+	printf("\n");
+	printf("===============================================\n");
+	printf("  Benchmark Suite: I/O Paths\n");
+	printf("===============================================\n");
+	printf("%.1f sec per point, %ld CPUs\n", seconds, sysconf(_SC_NPROCESSORS_ONLN));
+	
+	for (int s = 0; s < SUITE_COUNT; s++) {
+		if (enabled[s] && suites[s]() < 0)
+			ret = 1;
+	}
+	
+	printf("\n");
+	printf("===============================================\n");
+	printf("  Benchmarks Complete\n");
+	printf("===============================================\n");
+	printf("\n");
+	
+	if (out)
+		fclose(out);
+	return ret;
+}
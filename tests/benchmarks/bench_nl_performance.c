@@ -0,0 +1,296 @@
+/* bench_nl_performance.c - Netlink attribute decoding benchmark
+ *
+ * Compares the switch-based parsers with the table-driven decoder
+ * (nlmon_nl_table_decode) on link, address, route and conntrack messages.
+ */
+
+#include "benchmark_framework.h"
+#include <string.h>
+#include <arpa/inet.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+#include <netlink/msg.h>
+#include <netlink/attr.h>
+
+#include "event_processor.h"
+#include "nlmon_nl_optimize.h"
+#include "nlmon_nl_route.h"
+#include "nlmon_nl_netfilter.h"
+
+static struct nl_msg *g_link_msg;
+static struct nl_msg *g_addr_msg;
+static struct nl_msg *g_route_msg;
+static struct nl_msg *g_ct_msg;
+
+static struct nlmon_link_info g_link_info;
+static struct nlmon_addr_info g_addr_info;
+static struct nlmon_route_info g_route_info;
+static struct nlmon_ct_info g_ct_info;
+
+static struct nl_msg *build_link_msg(void)
+{
+	struct nl_msg *msg = nlmsg_alloc_simple(RTM_NEWLINK, 0);
+	struct ifinfomsg ifi = { .ifi_family = AF_UNSPEC, .ifi_index = 2, .ifi_flags = 0x1043 };
+	unsigned char mac[ETH_ALEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+	
+	if (!msg)
+		return NULL;
+	
+	nlmsg_append(msg, &ifi, sizeof(ifi), NLMSG_ALIGNTO);
+	nla_put_string(msg, IFLA_IFNAME, "eth0");
+	nla_put_u32(msg, IFLA_TXQLEN, 1000);
+	nla_put_u8(msg, IFLA_OPERSTATE, 6);
+	nla_put_u8(msg, IFLA_LINKMODE, 0);
+	nla_put_u32(msg, IFLA_MTU, 1500);
+	nla_put_u32(msg, IFLA_GROUP, 0);
+	nla_put_u32(msg, IFLA_PROMISCUITY, 0);
+	nla_put_u32(msg, IFLA_NUM_TX_QUEUES, 4);
+	nla_put_u32(msg, IFLA_NUM_RX_QUEUES, 4);
+	nla_put_u8(msg, IFLA_CARRIER, 1);
+	nla_put_string(msg, IFLA_QDISC, "mq");
+	nla_put(msg, IFLA_ADDRESS, sizeof(mac), mac);
+	nla_put(msg, IFLA_BROADCAST, sizeof(mac), "\xff\xff\xff\xff\xff\xff");
+	
+	return msg;
+}
+
+static struct nl_msg *build_addr_msg(void)
+{
+	struct nl_msg *msg = nlmsg_alloc_simple(RTM_NEWADDR, 0);
+	struct ifaddrmsg ifa = { .ifa_family = AF_INET, .ifa_prefixlen = 24, .ifa_index = 2 };
+	struct in_addr addr;
+	
+	if (!msg)
+		return NULL;
+	
+	inet_pton(AF_INET, "192.168.1.10", &addr);
+	nlmsg_append(msg, &ifa, sizeof(ifa), NLMSG_ALIGNTO);
+	nla_put(msg, IFA_ADDRESS, sizeof(addr), &addr);
+	nla_put(msg, IFA_LOCAL, sizeof(addr), &addr);
+	nla_put_string(msg, IFA_LABEL, "eth0");
+	nla_put_u32(msg, IFA_FLAGS, 0x80);
+	
+	return msg;
+}
+
+static struct nl_msg *build_route_msg(void)
+{
+	struct nl_msg *msg = nlmsg_alloc_simple(RTM_NEWROUTE, 0);
+	struct rtmsg rtm = {
+		.rtm_family = AF_INET, .rtm_dst_len = 24, .rtm_table = RT_TABLE_MAIN,
+		.rtm_protocol = RTPROT_KERNEL, .rtm_scope = RT_SCOPE_LINK, .rtm_type = RTN_UNICAST
+	};
+	struct in_addr dst, src, gw;
+	
+	if (!msg)
+		return NULL;
+	
+	inet_pton(AF_INET, "192.168.1.0", &dst);
+	inet_pton(AF_INET, "192.168.1.10", &src);
+	inet_pton(AF_INET, "192.168.1.1", &gw);
+	nlmsg_append(msg, &rtm, sizeof(rtm), NLMSG_ALIGNTO);
+	nla_put_u32(msg, RTA_TABLE, RT_TABLE_MAIN);
+	nla_put(msg, RTA_DST, sizeof(dst), &dst);
+	nla_put(msg, RTA_PREFSRC, sizeof(src), &src);
+	nla_put(msg, RTA_GATEWAY, sizeof(gw), &gw);
+	nla_put_u32(msg, RTA_OIF, 2);
+	nla_put_u32(msg, RTA_PRIORITY, 100);
+	
+	return msg;
+}
+
+static struct nl_msg *build_ct_msg(void)
+{
+	struct nl_msg *msg = nlmsg_alloc_simple((NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_NEW, 0);
+	struct nfgenmsg nfg = { .nfgen_family = AF_INET, .version = NFNETLINK_V0 };
+	struct nlattr *tuple, *nest;
+	struct in_addr src, dst;
+	
+	if (!msg)
+		return NULL;
+	
+	inet_pton(AF_INET, "10.0.0.1", &src);
+	inet_pton(AF_INET, "10.0.0.2", &dst);
+	nlmsg_append(msg, &nfg, sizeof(nfg), NLMSG_ALIGNTO);
+	
+	tuple = nla_nest_start(msg, CTA_TUPLE_ORIG);
+	nest = nla_nest_start(msg, CTA_TUPLE_IP);
+	nla_put(msg, CTA_IP_V4_SRC, sizeof(src), &src);
+	nla_put(msg, CTA_IP_V4_DST, sizeof(dst), &dst);
+	nla_nest_end(msg, nest);
+	nest = nla_nest_start(msg, CTA_TUPLE_PROTO);
+	nla_put_u8(msg, CTA_PROTO_NUM, IPPROTO_TCP);
+	nla_put_u16(msg, CTA_PROTO_SRC_PORT, htons(40000));
+	nla_put_u16(msg, CTA_PROTO_DST_PORT, htons(443));
+	nla_nest_end(msg, nest);
+	nla_nest_end(msg, tuple);
+	
+	nest = nla_nest_start(msg, CTA_PROTOINFO);
+	tuple = nla_nest_start(msg, CTA_PROTOINFO_TCP);
+	nla_put_u8(msg, CTA_PROTOINFO_TCP_STATE, 3);
+	nla_nest_end(msg, tuple);
+	nla_nest_end(msg, nest);
+	
+	nla_put_u32(msg, CTA_MARK, htonl(0x10));
+	
+	nest = nla_nest_start(msg, CTA_COUNTERS_ORIG);
+	nla_put_u64(msg, CTA_COUNTERS_PACKETS, htobe64(12));
+	nla_put_u64(msg, CTA_COUNTERS_BYTES, htobe64(3400));
+	nla_nest_end(msg, nest);
+	
+	return msg;
+}
+
+/* Release the info structure allocated by an event parser */
+static void free_event_data(struct nlmon_event *evt)
+{
+	free(evt->netlink.data.generic);
+	evt->netlink.data.generic = NULL;
+}
+
+BENCHMARK(link_switch_fast, 1000000)
+{
+	nlmon_parse_link_msg_fast(nlmsg_hdr(g_link_msg), &g_link_info);
+}
+
+BENCHMARK(link_table, 1000000)
+{
+	nlmon_nl_table_decode(&nlmon_nl_link_decoder, nlmsg_hdr(g_link_msg), &g_link_info);
+}
+
+BENCHMARK(addr_switch_fast, 1000000)
+{
+	nlmon_parse_addr_msg_fast(nlmsg_hdr(g_addr_msg), &g_addr_info);
+}
+
+BENCHMARK(addr_table, 1000000)
+{
+	nlmon_nl_table_decode(&nlmon_nl_addr_decoder, nlmsg_hdr(g_addr_msg), &g_addr_info);
+}
+
+BENCHMARK(route_nlmsg_parse, 1000000)
+{
+	struct nlmon_event evt = {0};
+	
+	nlmon_parse_route_msg(nlmsg_hdr(g_route_msg), &evt);
+	free_event_data(&evt);
+}
+
+BENCHMARK(route_table, 1000000)
+{
+	nlmon_nl_table_decode(&nlmon_nl_route_decoder, nlmsg_hdr(g_route_msg), &g_route_info);
+}
+
+BENCHMARK(conntrack_nlmsg_parse, 1000000)
+{
+	struct nlmon_event evt = {0};
+	
+	nlmon_parse_conntrack_msg(nlmsg_hdr(g_ct_msg), &evt);
+	free_event_data(&evt);
+}
+
+BENCHMARK(conntrack_table, 1000000)
+{
+	nlmon_nl_table_decode(&nlmon_nl_ct_decoder, nlmsg_hdr(g_ct_msg), &g_ct_info);
+}
+
+THROUGHPUT_BENCHMARK(table_decode_mixed_throughput, 2.0)
+{
+	struct nl_msg *msgs[] = { g_link_msg, g_addr_msg, g_route_msg, g_ct_msg };
+	union {
+		struct nlmon_link_info link;
+		struct nlmon_addr_info addr;
+		struct nlmon_route_info route;
+		struct nlmon_ct_info ct;
+	} out;
+	uint64_t n = 0;
+	size_t i;
+	
+	for (i = 0; i < sizeof(msgs) / sizeof(msgs[0]); i++) {
+		struct nlmsghdr *nlh = nlmsg_hdr(msgs[i]);
+		const struct nlmon_nl_decode_table *t;
+		
+		t = nlmon_nl_decoder_lookup(i == 3 ? NETLINK_NETFILTER : NETLINK_ROUTE, nlh->nlmsg_type);
+		if (t && nlmon_nl_table_decode(t, nlh, &out) == 0)
+			n++;
+	}
+	
+	return n;
+}
+
+/* Both decoders must agree before their timings mean anything */
+static int check_equivalence(void)
+{
+	struct nlmon_link_info link_fast, link_table;
+	struct nlmon_addr_info addr_fast, addr_table;
+	struct nlmon_event evt = {0};
+	int ret = 0;
+	
+	nlmon_parse_link_msg_fast(nlmsg_hdr(g_link_msg), &link_fast);
+	nlmon_nl_table_decode(&nlmon_nl_link_decoder, nlmsg_hdr(g_link_msg), &link_table);
+	if (memcmp(&link_fast, &link_table, sizeof(link_fast)) != 0) {
+		printf("link decoders disagree\n");
+		ret = -1;
+	}
+	
+	nlmon_parse_addr_msg_fast(nlmsg_hdr(g_addr_msg), &addr_fast);
+	nlmon_nl_table_decode(&nlmon_nl_addr_decoder, nlmsg_hdr(g_addr_msg), &addr_table);
+	if (memcmp(&addr_fast, &addr_table, sizeof(addr_fast)) != 0) {
+		printf("address decoders disagree\n");
+		ret = -1;
+	}
+	
+	nlmon_parse_route_msg(nlmsg_hdr(g_route_msg), &evt);
+	nlmon_nl_table_decode(&nlmon_nl_route_decoder, nlmsg_hdr(g_route_msg), &g_route_info);
+	if (!evt.netlink.data.route ||
+	    memcmp(evt.netlink.data.route, &g_route_info, sizeof(g_route_info)) != 0) {
+		printf("route decoders disagree\n");
+		ret = -1;
+	}
+	free_event_data(&evt);
+	
+	nlmon_nl_table_decode(&nlmon_nl_ct_decoder, nlmsg_hdr(g_ct_msg), &g_ct_info);
+	if (strcmp(g_ct_info.src_addr, "10.0.0.1") || strcmp(g_ct_info.dst_addr, "10.0.0.2") ||
+	    g_ct_info.protocol != IPPROTO_TCP || g_ct_info.src_port != 40000 ||
+	    g_ct_info.dst_port != 443 || g_ct_info.tcp_state != 3 || g_ct_info.mark != 0x10 ||
+	    g_ct_info.packets_orig != 12 || g_ct_info.bytes_orig != 3400) {
+		printf("conntrack table decode mismatch\n");
+		ret = -1;
+	}
+	
+	return ret;
+}
+
+BENCHMARK_SUITE_BEGIN("Netlink Attribute Decoding")
+	g_link_msg = build_link_msg();
+	g_addr_msg = build_addr_msg();
+	g_route_msg = build_route_msg();
+	g_ct_msg = build_ct_msg();
+
+	if (!g_link_msg || !g_addr_msg || !g_route_msg || !g_ct_msg) {
+		printf("Failed to build test messages\n");
+		return 1;
+	}
+
+	if (check_equivalence() < 0)
+		return 1;
+
+	/* Run benchmarks */
+	RUN_BENCHMARK(link_switch_fast);
+	RUN_BENCHMARK(link_table);
+	RUN_BENCHMARK(addr_switch_fast);
+	RUN_BENCHMARK(addr_table);
+	RUN_BENCHMARK(route_nlmsg_parse);
+	RUN_BENCHMARK(route_table);
+	RUN_BENCHMARK(conntrack_nlmsg_parse);
+	RUN_BENCHMARK(conntrack_table);
+	RUN_THROUGHPUT_BENCHMARK(table_decode_mixed_throughput);
+
+	/* Cleanup */
+	nlmsg_free(g_link_msg);
+	nlmsg_free(g_addr_msg);
+	nlmsg_free(g_route_msg);
+	nlmsg_free(g_ct_msg);
+BENCHMARK_SUITE_END()
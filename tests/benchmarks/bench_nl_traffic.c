@@ -0,0 +1,321 @@
+/* bench_nl_traffic.c - Netlink load generator
+ *
+ * Feeds synthetic netlink traffic (see nl_traffic_gen.h) straight into
+ * nlmon's parsers, at full speed or a set rate, and reports what they
+ * kept up with.
+ *
+ * Usage:
+ *   bench_nl_traffic [-m mode] [-d seconds] [-r rate] [-b burst]
+ *                    [-x mix] [-c cardinality] [-D delete%] [-s seed]
+ *
+ *   -m  decode:   table-driven decoders only (no events)
+ *       parse:    the parsers the receive path runs, into events (default)
+ *       pipeline: parse and submit the events to an event processor
+ *   -d  Length of the run (default 5)
+ *   -r  Messages per second, 0 for as fast as possible (default 0)
+ *   -b  Messages per receive buffer; with -r, the size of the bursts
+ *       they arrive in (default 64)
+ *   -x  Message mix, e.g. "link=1,addr=2,route=8,neigh=8,ct=40,wifi=2"
+ *   -c  Cardinality, e.g. "if=64,addr=1024,route=100000,neigh=4096,flow=1000000"
+ *   -D  Share of messages deleting an object (default 25)
+ *   -s  Random seed
+ *
+ * For traffic through the kernel instead, nl_churn.sh churns dummy
+ * interfaces, addresses, routes and neighbours in a network namespace.
+ */
+
+#include "benchmark_framework.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/rtnetlink.h>
+#include <linux/netlink.h>
+
+#include "nl_traffic_gen.h"
+#include "event_processor.h"
+#include "nlmon_nl_event.h"
+#include "nlmon_nl_optimize.h"
+#include "nlmon_nl_route.h"
+#include "nlmon_nl_netfilter.h"
+
+#define USAGE "Usage: %s [-m decode|parse|pipeline] [-d seconds] [-r rate] [-b burst]\n" \
+              "       [-x mix] [-c cardinality] [-D delete%%] [-s seed]\n"
+
+#define MAX_BURST 4096
+
+enum traffic_mode {
+	MODE_DECODE,
+	MODE_PARSE,
+	MODE_PIPELINE,
+};
+
+struct traffic_stats {
+	uint64_t messages;
+	uint64_t bytes;
+	uint64_t errors;
+	uint64_t per_kind[NL_GEN_KIND_COUNT];
+};
+
+static _Atomic uint64_t g_handled;
+
+static void count_event(struct nlmon_event *event, void *ctx)
+{
+	atomic_fetch_add_explicit(&g_handled, 1, memory_order_relaxed);
+}
+
+static int parse_message(struct nlmsghdr *nlh, enum nl_gen_kind kind, struct nlmon_event *evt)
+{
+	return nlmon_nl_parse_message(nlh, evt, nl_gen_protocol(kind));
+}
+
+static int decode_message(struct nlmsghdr *nlh, enum nl_gen_kind kind)
+{
+	const struct nlmon_nl_decode_table *table;
+	union {
+		struct nlmon_link_info link;
+		struct nlmon_addr_info addr;
+		struct nlmon_route_info route;
+		struct nlmon_neigh_info neigh;
+		struct nlmon_ct_info ct;
+	} out;
+	
+	/* nl80211 has no decode table, its parser only collects attributes */
+	if (kind == NL_GEN_NL80211) {
+		struct nlmon_event evt;
+		int ret = parse_message(nlh, kind, &evt);
+		
+		free(evt.netlink.data.generic);
+		return ret;
+	}
+	
+	table = nlmon_nl_decoder_lookup(nl_gen_protocol(kind), nlh->nlmsg_type);
+	if (!table)
+		return -ENOTSUP;
+	return nlmon_nl_table_decode(table, nlh, &out);
+}
+
+/* Handle one receive buffer of @count messages */
+static void consume_buffer(enum traffic_mode mode, struct event_processor *ep, void *buf,
+                           size_t len, const enum nl_gen_kind *kinds, size_t count,
+                           struct traffic_stats *stats)
+{
+	static struct nlmon_event events[MAX_BURST];
+	struct nlmsghdr *nlh = buf;
+	int remaining = len;
+	size_t i, n = 0;
+	
+	for (i = 0; i < count && NLMSG_OK(nlh, remaining); i++, nlh = NLMSG_NEXT(nlh, remaining)) {
+		int ret;
+		
+		stats->per_kind[kinds[i]]++;
+		
+		if (mode == MODE_DECODE) {
+			if (decode_message(nlh, kinds[i]) < 0)
+				stats->errors++;
+			continue;
+		}
+		
+		ret = parse_message(nlh, kinds[i], &events[n]);
+		if (ret < 0) {
+			free(events[n].netlink.data.generic);
+			stats->errors++;
+			continue;
+		}
+		n++;
+	}
+	
+	stats->messages += count;
+	stats->bytes += len;
+	
+	if (mode == MODE_PIPELINE) {
+		/* Submitted copies take the payload along, as from a receive thread */
+		for (i = 0; i < n; i++) {
+			events[i].data_size = nlmon_nl_event_payload_size(&events[i]);
+			events[i].data = events[i].data_size ? events[i].netlink.data.generic : NULL;
+		}
+		event_processor_submit_batch(ep, 0, events, n);
+	}
+	
+	for (i = 0; i < n; i++)
+		free(events[i].netlink.data.generic);
+}
+
+/* Parse "name=value,..." pairs into the cardinality fields */
+static int parse_cardinality(struct nl_gen_config *config, char *spec)
+{
+	char *saveptr = NULL, *item;
+	
+	for (item = strtok_r(spec, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+		char *eq = strchr(item, '=');
+		unsigned long value;
+		
+		if (!eq)
+			return -1;
+		*eq = '\0';
+		value = strtoul(eq + 1, NULL, 10);
+		if (!value || value > UINT32_MAX)
+			return -1;
+		
+		if (!strcmp(item, "if"))
+			config->interfaces = value;
+		else if (!strcmp(item, "addr"))
+			config->addresses = value;
+		else if (!strcmp(item, "route"))
+			config->routes = value;
+		else if (!strcmp(item, "neigh"))
+			config->neighbours = value;
+		else if (!strcmp(item, "flow"))
+			config->flows = value;
+		else
+			return -1;
+	}
+	return 0;
+}
+
+static void sleep_until(uint64_t deadline_ns)
+{
+	uint64_t now = benchmark_get_time_ns();
+	struct timespec ts;
+	
+	if (now >= deadline_ns)
+		return;
+	ts.tv_sec = (deadline_ns - now) / 1000000000ULL;
+	ts.tv_nsec = (deadline_ns - now) % 1000000000ULL;
+	nanosleep(&ts, NULL);
+}
+
+int main(int argc, char **argv)
+{
+	static uint8_t buf[MAX_BURST * NL_GEN_MAX_MSG] __attribute__((aligned(NLMSG_ALIGNTO)));
+	static enum nl_gen_kind kinds[MAX_BURST];
+	enum traffic_mode mode = MODE_PARSE;
+	struct nl_gen_config config = { 0 };
+	struct traffic_stats stats = { 0 };
+	struct event_processor *ep = NULL;
+	unsigned long burst = 64;
+	double seconds = 5, rate = 0, elapsed;
+	uint64_t start, end, now;
+	int opt, i;
+	
+	while ((opt = getopt(argc, argv, "m:d:r:b:x:c:D:s:")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (!strcmp(optarg, "decode"))
+				mode = MODE_DECODE;
+			else if (!strcmp(optarg, "parse"))
+				mode = MODE_PARSE;
+			else if (!strcmp(optarg, "pipeline"))
+				mode = MODE_PIPELINE;
+			else
+				goto usage;
+			break;
+		case 'd':
+			seconds = atof(optarg);
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 'b':
+			burst = strtoul(optarg, NULL, 10);
+			break;
+		case 'x':
+			if (nl_gen_parse_mix(&config, optarg) < 0) {
+				fprintf(stderr, "Invalid mix: %s\n", optarg);
+				return 2;
+			}
+			break;
+		case 'c':
+			if (parse_cardinality(&config, optarg) < 0) {
+				fprintf(stderr, "Invalid cardinality: %s\n", optarg);
+				return 2;
+			}
+			break;
+		case 'D':
+			config.delete_percent = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			config.seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	
+	if (optind != argc || seconds <= 0 || rate < 0 || !burst || burst > MAX_BURST ||
+	    config.delete_percent > 100)
+		goto usage;
+	
+	struct nl_gen gen;
+	
+	if (nl_gen_init(&gen, &config) < 0) {
+		fprintf(stderr, "The mix selects no messages\n");
+		return 2;
+	}
+	
+	if (mode == MODE_PIPELINE) {
+		struct event_processor_config ep_config = {
+			.ring_buffer_size = 65536,
+			.thread_pool_size = 2,
+			.work_queue_size = 4096,
+		};
+		
+		ep = event_processor_create(&ep_config);
+		if (!ep || event_processor_register_handler(ep, count_event, NULL) < 0) {
+			fprintf(stderr, "Failed to create the event processor\n");
+			return 1;
+		}
+	}
+	
+	printf("=== Netlink traffic: %s, %s, %lu per buffer ===\n",
+	       mode == MODE_DECODE ? "decode" : mode == MODE_PARSE ? "parse" : "pipeline",
+	       rate ? "paced" : "unpaced", burst);
+	printf("Cardinality: %u interfaces, %u addresses, %u routes, %u neighbours, %u flows\n",
+	       gen.config.interfaces, gen.config.addresses, gen.config.routes,
+	       gen.config.neighbours, gen.config.flows);
+	
+	start = benchmark_get_time_ns();
+	end = start + (uint64_t)(seconds * 1e9);
+	
+	for (now = start; now < end; now = benchmark_get_time_ns()) {
+		size_t count, len;
+		
+		/* A burst is due once the rate allows for the messages before it */
+		if (rate > 0)
+			sleep_until(start + (uint64_t)(stats.messages / rate * 1e9));
+		
+		len = nl_gen_fill(&gen, buf, sizeof(buf), burst, kinds, &count);
+		consume_buffer(mode, ep, buf, len, kinds, count, &stats);
+	}
+	elapsed = (benchmark_get_time_ns() - start) / 1e9;
+	
+	printf("Messages:      %llu (%llu errors)\n", (unsigned long long)stats.messages,
+	       (unsigned long long)stats.errors);
+	printf("Throughput:    %.0f msgs/sec, %.1f MB/sec\n", stats.messages / elapsed,
+	       stats.bytes / elapsed / 1e6);
+	for (i = 0; i < NL_GEN_KIND_COUNT; i++) {
+		if (stats.per_kind[i])
+			printf("  %-6s       %llu\n", nl_gen_kind_name(i),
+			       (unsigned long long)stats.per_kind[i]);
+	}
+	
+	if (ep) {
+		unsigned long submitted, processed, dropped, rate_limited;
+		size_t queue_size, pool_usage;
+		
+		/* Drops are final once submitting stopped, the queue is drained below */
+		event_processor_stats(ep, &submitted, &processed, &dropped, &rate_limited,
+		                      &queue_size, &pool_usage);
+		event_processor_destroy(ep, true);
+		
+		printf("Submitted:     %lu (%lu dropped, %lu queued at the end)\n",
+		       submitted, dropped, (unsigned long)queue_size);
+		printf("Handled:       %llu\n", (unsigned long long)atomic_load(&g_handled));
+	}
+	
+	return stats.errors ? 1 : 0;
+	
+usage:
+	fprintf(stderr, USAGE, argv[0]);
+	return 2;
+}
@@ -0,0 +1,51 @@
+/* bench_profiler.c - Cost of profiler probes */
+
+#include "benchmark_framework.h"
+#include "performance_profiler.h"
+
+/* Probes per call, so the benchmark loop's own clock reads amortize */
+#define PROBES_PER_CALL 1000
+
+static struct performance_profiler *profiler;
+static int probe_op;
+
+THROUGHPUT_BENCHMARK(probe_throughput, 2.0)
+{
+	for (int i = 0; i < PROBES_PER_CALL; i++) {
+		uint64_t start = PROFILE_PROBE_START();
+		
+		PROFILE_PROBE_END(profiler, probe_op, start);
+	}
+	return PROBES_PER_CALL;
+}
+
+THROUGHPUT_BENCHMARK(record_by_name_throughput, 2.0)
+{
+	for (int i = 0; i < PROBES_PER_CALL; i++)
+		performance_profiler_record(profiler, "event_dispatch", 1000, NULL);
+	return PROBES_PER_CALL;
+}
+
+THROUGHPUT_BENCHMARK(start_end_throughput, 2.0)
+{
+	for (int i = 0; i < PROBES_PER_CALL; i++)
+		PROFILE_END(profiler, PROFILE_START(profiler, "event_dispatch"));
+	return PROBES_PER_CALL;
+}
+
+BENCHMARK_SUITE_BEGIN("Profiler")
+	profiler = performance_profiler_create(0, 0);
+	if (!profiler) {
+		fprintf(stderr, "Failed to create profiler\n");
+		return 1;
+	}
+	probe_op = performance_profiler_register(profiler, "event_dispatch");
+
+	RUN_THROUGHPUT_BENCHMARK(probe_throughput);
+	RUN_THROUGHPUT_BENCHMARK(record_by_name_throughput);
+	RUN_THROUGHPUT_BENCHMARK(start_end_throughput);
+
+	printf("\nDropped samples: %lu\n",
+	       (unsigned long)performance_profiler_get_dropped(profiler));
+	performance_profiler_destroy(profiler);
+BENCHMARK_SUITE_END()
@@ -0,0 +1,627 @@
+/* bench_replay.c - Replay captured netlink traffic through the pipeline
+ *
+ * Reads a capture of the pcap exporter, classic pcap or pcapng, and
+ * replays its messages through parsing, the event processor, the
+ * filter and the in-memory event history, as the receive threads
+ * would feed them. Reports throughput, latency percentiles of each
+ * stage since receipt, drops and memory use, so regressions show on
+ * the traffic shapes of the capture.
+ *
+ * Usage:
+ *   bench_replay [-s speed] [-l loops] [-f filter] [-p protocol]
+ *                [-w workers] [-b batch] [-H history] [capture]
+ *
+ *   -s  Replay speed, 1 for the capture's own pace, N for N times
+ *       faster, 0 for as fast as possible (default 0)
+ *   -l  Times to replay the capture (default 1)
+ *   -f  Filter expression the events are evaluated against
+ *   -p  Protocol of messages the capture does not give one for:
+ *       route, generic, netfilter or diag (default route)
+ *   -w  Event processor worker threads (default 2)
+ *   -b  Messages per submitted batch (default 32)
+ *   -H  Events kept in the history buffer, 0 for none (default 10000)
+ *
+ * pcapng captures of the exporter name each message's protocol in its
+ * comment, Linux cooked captures (e.g. tcpdump -i nlmon0) in the cooked
+ * header. Other messages are taken for netfilter by their message type
+ * or else for the -p protocol. Without a capture, 100000 messages of
+ * nl_traffic_gen are replayed instead.
+ */
+
+#include "benchmark_framework.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <linux/netlink.h>
+
+#include "nl_traffic_gen.h"
+#include "event_processor.h"
+#include "event_trace.h"
+#include "hdr_histogram.h"
+#include "nlmon_nl_event.h"
+#include "storage_buffer.h"
+#include "filter_parser.h"
+#include "filter_compiler.h"
+#include "filter_eval.h"
+
+#define USAGE "Usage: %s [-s speed] [-l loops] [-f filter] [-p protocol] [-w workers]\n" \
+              "       [-b batch] [-H history] [capture]\n"
+
+#define MAX_BATCH 1024
+#define SYNTHETIC_MESSAGES 100000
+
+/* Link types of the captures */
+#define LINKTYPE_NETLINK 253
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_LINUX_SLL2 276
+
+/* pcapng blocks and options */
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_IF_TSRESOL 9
+#define PCAPNG_MAX_INTERFACES 64
+
+/* One captured message */
+struct replay_record {
+	uint64_t timestamp_ns;
+	const uint8_t *data;
+	uint32_t len;
+	int protocol;
+};
+
+struct replay_trace {
+	uint8_t *file;
+	struct replay_record *records;
+	size_t count;
+	size_t capacity;
+	uint64_t bytes;
+};
+
+/* Pipeline state shared with the handler */
+struct replay_pipeline {
+	struct filter_bytecode *filter;
+	struct storage_buffer *history;
+	_Atomic uint64_t handled;
+	_Atomic uint64_t matched;
+	struct hdr_histogram *stage[NLMON_TRACE_STAGES];
+};
+
+static struct replay_pipeline g_pipeline;
+
+static int add_record(struct replay_trace *trace, uint64_t ts_ns, const uint8_t *data,
+                      uint32_t len, int protocol)
+{
+	struct replay_record *r;
+	
+	if (len < NLMSG_HDRLEN)
+		return 0;
+	
+	if (trace->count == trace->capacity) {
+		size_t capacity = trace->capacity ? trace->capacity * 2 : 4096;
+		
+		r = realloc(trace->records, capacity * sizeof(*r));
+		if (!r)
+			return -1;
+		trace->records = r;
+		trace->capacity = capacity;
+	}
+	
+	r = &trace->records[trace->count++];
+	r->timestamp_ns = ts_ns;
+	r->data = data;
+	r->len = len;
+	r->protocol = protocol;
+	trace->bytes += len;
+	return 0;
+}
+
+/* Strip the link layer header, giving the protocol when it has one */
+static const uint8_t *link_payload(uint32_t linktype, const uint8_t *p, uint32_t *len,
+                                   int *protocol)
+{
+	switch (linktype) {
+	case LINKTYPE_NETLINK:
+		return p;
+	case LINKTYPE_LINUX_SLL:
+		if (*len < 16)
+			return NULL;
+		*protocol = p[14] << 8 | p[15];
+		*len -= 16;
+		return p + 16;
+	case LINKTYPE_LINUX_SLL2:
+		if (*len < 20)
+			return NULL;
+		*protocol = p[0] << 8 | p[1];
+		*len -= 20;
+		return p + 20;
+	default:
+		return NULL;
+	}
+}
+
+static int load_pcap(struct replay_trace *trace, const uint8_t *p, size_t size)
+{
+	uint32_t magic, linktype;
+	uint64_t ts_scale;
+	size_t off = 24;
+	
+	memcpy(&magic, p, 4);
+	if (magic == 0xa1b2c3d4)
+		ts_scale = 1000;
+	else if (magic == 0xa1b23c4d)
+		ts_scale = 1;
+	else
+		return -1;
+	memcpy(&linktype, p + 20, 4);
+	
+	while (off + 16 <= size) {
+		uint32_t hdr[4], len;
+		const uint8_t *data;
+		int protocol = -1;
+		
+		memcpy(hdr, p + off, sizeof(hdr));
+		off += 16;
+		if (hdr[2] > size - off)
+			break;
+		
+		len = hdr[2];
+		data = link_payload(linktype, p + off, &len, &protocol);
+		if (data && add_record(trace, (uint64_t)hdr[0] * 1000000000ULL + hdr[1] * ts_scale,
+		                       data, len, protocol) < 0)
+			return -1;
+		off += hdr[2];
+	}
+	return 0;
+}
+
+/* The exporter's comments read "... protocol=N ..." */
+static int comment_protocol(const uint8_t *options, size_t len, int protocol)
+{
+	size_t off = 0;
+	
+	while (off + 4 <= len) {
+		uint16_t code, olen;
+		char text[256];
+		
+		memcpy(&code, options + off, 2);
+		memcpy(&olen, options + off + 2, 2);
+		off += 4;
+		if (code == 0 || olen > len - off)
+			break;
+		if (code == PCAPNG_OPT_COMMENT) {
+			const char *s;
+			size_t n = olen < sizeof(text) - 1 ? olen : sizeof(text) - 1;
+			
+			memcpy(text, options + off, n);
+			text[n] = '\0';
+			s = strstr(text, "protocol=");
+			if (s)
+				return atoi(s + 9);
+		}
+		off += (olen + 3) & ~3u;
+	}
+	return protocol;
+}
+
+static int load_pcapng(struct replay_trace *trace, const uint8_t *p, size_t size)
+{
+	uint32_t linktype[PCAPNG_MAX_INTERFACES];
+	uint64_t tick_ns[PCAPNG_MAX_INTERFACES];
+	unsigned int interfaces = 0;
+	size_t off = 0;
+	
+	while (off + 12 <= size) {
+		uint32_t type, total;
+		
+		memcpy(&type, p + off, 4);
+		memcpy(&total, p + off + 4, 4);
+		if (total < 12 || total > size - off)
+			break;
+		
+		if (type == PCAPNG_SHB) {
+			/* Interface ids start over with each section */
+			interfaces = 0;
+		} else if (type == PCAPNG_IDB && total >= 20 && interfaces < PCAPNG_MAX_INTERFACES) {
+			size_t opt = off + 16, end = off + total - 4;
+			uint16_t lt;
+			
+			memcpy(&lt, p + off + 8, 2);
+			linktype[interfaces] = lt;
+			tick_ns[interfaces] = 1000;    /* Microseconds unless said otherwise */
+			while (opt + 4 <= end) {
+				uint16_t code, olen;
+				
+				memcpy(&code, p + opt, 2);
+				memcpy(&olen, p + opt + 2, 2);
+				if (code == 0)
+					break;
+				if (code == PCAPNG_IF_TSRESOL && olen == 1 && !(p[opt + 4] & 0x80)) {
+					uint64_t ns = 1000000000ULL;
+					int digits = p[opt + 4];
+					
+					while (digits-- > 0 && ns > 1)
+						ns /= 10;
+					tick_ns[interfaces] = ns ? ns : 1;
+				}
+				opt += 4 + ((olen + 3) & ~3u);
+			}
+			interfaces++;
+		} else if (type == PCAPNG_EPB && total >= 32) {
+			uint32_t epb[5], len;
+			const uint8_t *data;
+			int protocol = -1;
+			uint64_t ticks;
+			
+			memcpy(epb, p + off + 8, sizeof(epb));
+			len = epb[3];
+			if (epb[0] < interfaces && len <= total - 32) {
+				size_t opts = 28 + ((len + 3) & ~3u);
+				
+				ticks = (uint64_t)epb[1] << 32 | epb[2];
+				if (opts < total - 4)
+					protocol = comment_protocol(p + off + opts, total - 4 - opts, protocol);
+				data = link_payload(linktype[epb[0]], p + off + 28, &len, &protocol);
+				if (data && add_record(trace, ticks * tick_ns[epb[0]], data, len, protocol) < 0)
+					return -1;
+			}
+		}
+		off += total;
+	}
+	return 0;
+}
+
+static int load_capture(struct replay_trace *trace, const char *path, int default_protocol)
+{
+	FILE *f = fopen(path, "rb");
+	uint32_t magic;
+	long size;
+	int ret;
+	
+	if (!f)
+		return -1;
+	if (fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < 24 || fseek(f, 0, SEEK_SET) < 0) {
+		fclose(f);
+		errno = EINVAL;
+		return -1;
+	}
+	
+	trace->file = malloc(size);
+	if (!trace->file || fread(trace->file, 1, size, f) != (size_t)size) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	
+	memcpy(&magic, trace->file, 4);
+	if (magic == PCAPNG_SHB)
+		ret = load_pcapng(trace, trace->file, size);
+	else
+		ret = load_pcap(trace, trace->file, size);
+	if (ret < 0) {
+		errno = EINVAL;
+		return ret;
+	}
+
+	/*
+	 * Nothing says the protocol of raw netlink records. Netfilter
+	 * message types carry the subsystem above the low byte, other
+	 * types are taken to be of the default protocol.
+	 */
+	for (size_t i = 0; i < trace->count; i++) {
+		struct replay_record *r = &trace->records[i];
+		const struct nlmsghdr *nlh = (const struct nlmsghdr *)r->data;
+
+		if (r->protocol < 0)
+			r->protocol = nlh->nlmsg_type >= 0x100 ? NETLINK_NETFILTER : default_protocol;
+	}
+	return 0;
+}
+
+/* A trace of generated messages, a millisecond apart */
+static int synthesize_capture(struct replay_trace *trace)
+{
+	struct nl_gen gen;
+	enum nl_gen_kind kind;
+	size_t i, used = 0;
+	
+	if (nl_gen_init(&gen, NULL) < 0)
+		return -1;
+	
+	trace->file = malloc((size_t)SYNTHETIC_MESSAGES * NL_GEN_MAX_MSG);
+	if (!trace->file)
+		return -1;
+	
+	for (i = 0; i < SYNTHETIC_MESSAGES; i++) {
+		size_t len = nl_gen_next(&gen, trace->file + used, NL_GEN_MAX_MSG, &kind);
+		
+		if (add_record(trace, i * 1000000ULL, trace->file + used, len,
+		               nl_gen_protocol(kind)) < 0)
+			return -1;
+		used += len;
+	}
+	return 0;
+}
+
+static int parse_protocol(const char *name)
+{
+	if (!strcmp(name, "route"))
+		return NETLINK_ROUTE;
+	if (!strcmp(name, "generic"))
+		return NETLINK_GENERIC;
+	if (!strcmp(name, "netfilter"))
+		return NETLINK_NETFILTER;
+	if (!strcmp(name, "diag"))
+		return NETLINK_SOCK_DIAG;
+	return -1;
+}
+
+/* Stage latencies since receipt */
+static void trace_sink(const struct nlmon_event_trace *trace, enum nlmon_trace_stage stage,
+                       void *ctx)
+{
+	struct replay_pipeline *pipeline = ctx;
+	int i;
+	
+	for (i = 0; i < NLMON_TRACE_STAGES; i++) {
+		if (trace->offset_ns[i] && (stage == NLMON_TRACE_STAGES || stage == (enum nlmon_trace_stage)i))
+			hdr_histogram_record(pipeline->stage[i], trace->offset_ns[i]);
+	}
+}
+
+/* What nlmon does with a received event: filter, then keep it */
+static void replay_handler(struct nlmon_event *event, void *ctx)
+{
+	struct replay_pipeline *pipeline = ctx;
+	
+	atomic_fetch_add_explicit(&pipeline->handled, 1, memory_order_relaxed);
+	if (pipeline->filter && !filter_eval(pipeline->filter, event, NULL))
+		return;
+	nlmon_trace_stamp(&event->trace, NLMON_TRACE_FILTER);
+	atomic_fetch_add_explicit(&pipeline->matched, 1, memory_order_relaxed);
+	
+	if (pipeline->history)
+		storage_buffer_add(pipeline->history, event);
+}
+
+static void sleep_until(uint64_t deadline_ns)
+{
+	uint64_t now = benchmark_get_time_ns();
+	struct timespec ts;
+	
+	if (now >= deadline_ns)
+		return;
+	ts.tv_sec = (deadline_ns - now) / 1000000000ULL;
+	ts.tv_nsec = (deadline_ns - now) % 1000000000ULL;
+	nanosleep(&ts, NULL);
+}
+
+static void submit_events(struct event_processor *ep, struct nlmon_event *events, size_t n)
+{
+	size_t i;
+	
+	event_processor_submit_batch(ep, 0, events, n);
+	for (i = 0; i < n; i++)
+		free(events[i].netlink.data.generic);
+}
+
+/* Parse the messages of one record, submitting every @batch events */
+static size_t replay_record(struct event_processor *ep, const struct replay_record *r,
+                            struct nlmon_event *events, size_t n, size_t batch,
+                            uint64_t *messages, uint64_t *errors)
+{
+	struct nlmsghdr *nlh = (struct nlmsghdr *)r->data;
+	uint64_t recv_ns = nlmon_trace_now();
+	int remaining = r->len;
+	
+	for (; NLMSG_OK(nlh, remaining); nlh = NLMSG_NEXT(nlh, remaining)) {
+		struct nlmon_event *evt = &events[n];
+		
+		(*messages)++;
+		if (nlmon_nl_parse_message(nlh, evt, r->protocol) < 0) {
+			free(evt->netlink.data.generic);
+			(*errors)++;
+			continue;
+		}
+		
+		nlmon_trace_begin(&evt->trace, recv_ns);
+		nlmon_trace_stamp(&evt->trace, NLMON_TRACE_PARSE);
+		
+		/* Queued copies take the payload along, as from a receive thread */
+		evt->data_size = nlmon_nl_event_payload_size(evt);
+		evt->data = evt->data_size ? evt->netlink.data.generic : NULL;
+		evt->raw_msg = NULL;
+		evt->raw_msg_len = 0;
+		if (++n == batch) {
+			submit_events(ep, events, n);
+			n = 0;
+		}
+	}
+	return n;
+}
+
+static long rss_kb(void)
+{
+	long pages = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+	
+	if (f) {
+		if (fscanf(f, "%*d %ld", &pages) != 1)
+			pages = 0;
+		fclose(f);
+	}
+	return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+int main(int argc, char **argv)
+{
+	static struct nlmon_event events[MAX_BATCH];
+	struct replay_trace trace = { 0 };
+	struct event_processor_config ep_config = {
+		.ring_buffer_size = 65536,
+		.thread_pool_size = 2,
+		.work_queue_size = 4096,
+	};
+	struct event_processor *ep;
+	struct filter_expr *expr = NULL;
+	const char *filter = NULL, *path = NULL;
+	unsigned long loops = 1, batch = 32, history = 10000;
+	unsigned long submitted, processed, dropped, rate_limited;
+	size_t queue_size, pool_usage, pending = 0, i;
+	uint64_t start, elapsed, errors = 0, messages = 0;
+	int protocol = NETLINK_ROUTE;
+	double speed = 0;
+	struct rusage usage;
+	long rss_start;
+	int opt, ret = 0;
+	
+	while ((opt = getopt(argc, argv, "s:l:f:p:w:b:H:")) != -1) {
+		switch (opt) {
+		case 's':
+			speed = atof(optarg);
+			break;
+		case 'l':
+			loops = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case 'p':
+			protocol = parse_protocol(optarg);
+			break;
+		case 'w':
+			ep_config.thread_pool_size = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			batch = strtoul(optarg, NULL, 10);
+			break;
+		case 'H':
+			history = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, USAGE, argv[0]);
+			return 2;
+		}
+	}
+	if (optind < argc)
+		path = argv[optind++];
+	if (optind != argc || speed < 0 || !loops || !batch || batch > MAX_BATCH || protocol < 0) {
+		fprintf(stderr, USAGE, argv[0]);
+		return 2;
+	}
+	
+	rss_start = rss_kb();
+	if (path ? load_capture(&trace, path, protocol) < 0 : synthesize_capture(&trace) < 0) {
+		fprintf(stderr, "%s: %s\n", path ? path : "synthetic trace", strerror(errno));
+		return 1;
+	}
+	if (!trace.count) {
+		fprintf(stderr, "%s: no netlink messages\n", path);
+		return 1;
+	}
+	
+	if (filter) {
+		expr = filter_parse(filter);
+		g_pipeline.filter = expr ? filter_compile(expr) : NULL;
+		if (!g_pipeline.filter) {
+			fprintf(stderr, "Invalid filter: %s\n", filter);
+			return 2;
+		}
+	}
+	if (history) {
+		g_pipeline.history = storage_buffer_create(history);
+		if (!g_pipeline.history)
+			return 1;
+	}
+	for (i = 0; i < NLMON_TRACE_STAGES; i++) {
+		g_pipeline.stage[i] = hdr_histogram_create(HDR_HISTOGRAM_DEFAULT_SCHEMA);
+		if (!g_pipeline.stage[i])
+			return 1;
+	}
+	
+	ep = event_processor_create(&ep_config);
+	if (!ep || event_processor_register_handler(ep, replay_handler, &g_pipeline) < 0) {
+		fprintf(stderr, "Failed to create the event processor\n");
+		return 1;
+	}
+	nlmon_trace_set_sink(trace_sink, &g_pipeline, 0);
+	
+	printf("=== Replay: %s ===\n", path ? path : "synthetic trace");
+	printf("Records:       %zu (%.1f MB), replayed %lu times %s\n", trace.count,
+	       trace.bytes / 1e6, loops, speed > 0 ? "paced" : "at full speed");
+	if (speed > 0)
+		printf("Speed:         %gx, capture spans %.3f sec\n", speed,
+		       (trace.records[trace.count - 1].timestamp_ns - trace.records[0].timestamp_ns) / 1e9);
+	
+	start = benchmark_get_time_ns();
+	for (unsigned long loop = 0; loop < loops; loop++) {
+		uint64_t loop_start = benchmark_get_time_ns();
+		
+		for (i = 0; i < trace.count; i++) {
+			const struct replay_record *r = &trace.records[i];
+			
+			if (speed > 0) {
+				/* Hand over the batch before waiting for the next message */
+				if (pending) {
+					submit_events(ep, events, pending);
+					pending = 0;
+				}
+				sleep_until(loop_start + (uint64_t)((r->timestamp_ns -
+				            trace.records[0].timestamp_ns) / speed));
+			}
+			
+			pending = replay_record(ep, r, events, pending, batch, &messages, &errors);
+		}
+	}
+	if (pending)
+		submit_events(ep, events, pending);
+	
+	/* The run ends once everything queued has been handled */
+	event_processor_wait(ep);
+	elapsed = benchmark_get_time_ns() - start;
+	event_processor_stats(ep, &submitted, &processed, &dropped, &rate_limited,
+	                      &queue_size, &pool_usage);
+	event_processor_destroy(ep, true);
+	nlmon_trace_set_sink(NULL, NULL, 0);
+	
+	printf("Messages:      %llu (%llu parse errors)\n", (unsigned long long)messages,
+	       (unsigned long long)errors);
+	printf("Throughput:    %.0f msgs/sec\n", messages / (elapsed / 1e9));
+	printf("Events:        %lu submitted, %lu dropped, %lu rate limited\n",
+	       submitted, dropped, rate_limited);
+	printf("Handled:       %llu, %llu passed the filter\n",
+	       (unsigned long long)atomic_load(&g_pipeline.handled),
+	       (unsigned long long)atomic_load(&g_pipeline.matched));
+	
+	printf("\n%-10s %10s %10s %10s %10s %10s  (usec since receipt)\n",
+	       "Stage", "p50", "p90", "p99", "p99.9", "max");
+	for (i = 0; i < NLMON_TRACE_STAGES; i++) {
+		struct hdr_histogram *h = g_pipeline.stage[i];
+		
+		if (!hdr_histogram_count(h))
+			continue;
+		printf("%-10s %10.1f %10.1f %10.1f %10.1f %10.1f\n", nlmon_trace_stage_name(i),
+		       hdr_histogram_quantile(h, 0.5) / 1e3, hdr_histogram_quantile(h, 0.9) / 1e3,
+		       hdr_histogram_quantile(h, 0.99) / 1e3, hdr_histogram_quantile(h, 0.999) / 1e3,
+		       hdr_histogram_max(h) / 1e3);
+	}
+	
+	getrusage(RUSAGE_SELF, &usage);
+	printf("\nRSS:           %ld KB at the end, %ld KB peak, %ld KB before loading\n",
+	       rss_kb(), usage.ru_maxrss, rss_start);
+	
+	if (errors == messages)
+		ret = 1;
+	
+	for (i = 0; i < NLMON_TRACE_STAGES; i++)
+		hdr_histogram_destroy(g_pipeline.stage[i]);
+	storage_buffer_destroy(g_pipeline.history);
+	filter_bytecode_free(g_pipeline.filter);
+	filter_expr_free(expr);
+	free(trace.records);
+	free(trace.file);
+	return ret;
+}
@@ -0,0 +1,530 @@
+/* bench_scaling.c - Producer/consumer scaling of the event path primitives
+ *
+ * Sweeps producer and consumer thread counts from 1 to the number of
+ * CPUs for the MPMC ring buffer, the object pool, the thread pool and the
+ * event processor, and reports for each point the throughput, the
+ * latency from hand-off by a producer to receipt by a consumer and the
+ * cache misses per operation.
+ *
+ * Usage:
+ *   bench_scaling [-d seconds] [-t threads] [-s suites] [-o results]
+ *
+ *   -d  Length of each point (default 1)
+ *   -t  Most producers and consumers (default: online CPUs)
+ *   -s  Comma separated suites: ring, pool, thread_pool, event_processor
+ *       (default all)
+ *   -o  Append results to a file, one JSON object per point, for
+ *       tracking across builds
+ *
+ * Thread counts double up to the maximum, which is always included.
+ * Producers run flat out, so latencies are those of a saturated queue.
+ * One item in LATENCY_SAMPLE carries its hand-off time, so timing does
+ * not dominate what it measures. Cache misses come from perf_event_open()
+ * and are left out where perf events are not permitted.
+ *
+ * Per suite, producers -> consumers are:
+ *   ring             enqueue -> dequeue on one MPMC ring
+ *   pool             allocate and pass on a ring -> free, across threads
+ *   thread_pool      submit -> work functions on the pool threads
+ *   event_processor  submit on a lane each -> handlers on the workers
+ */
+
+#include "benchmark_framework.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "ring_buffer.h"
+#include "object_pool.h"
+#include "thread_pool.h"
+#include "event_processor.h"
+#include "hdr_histogram.h"
+
+#define USAGE "Usage: %s [-d seconds] [-t threads] [-s ring,pool,thread_pool,event_processor]\n" \
+              "       [-o results]\n"
+
+#define MAX_THREADS 256
+#define RING_CAPACITY 65536
+#define POOL_OBJECT_SIZE 64
+#define CONSUMER_BULK 32
+
+/* One of this many items is timed */
+#define LATENCY_SAMPLE 64
+
+/* Stamp of items not timed, times are never this small */
+#define UNTIMED ((uintptr_t)1)
+
+enum scaling_suite {
+	SUITE_RING,
+	SUITE_POOL,
+	SUITE_THREAD_POOL,
+	SUITE_EVENT_PROCESSOR,
+	SUITE_COUNT
+};
+
+static const char *const suite_names[SUITE_COUNT] = {
+	[SUITE_RING] = "ring",
+	[SUITE_POOL] = "pool",
+	[SUITE_THREAD_POOL] = "thread_pool",
+	[SUITE_EVENT_PROCESSOR] = "event_processor",
+};
+
+/* Items one consumer received, a cache line each */
+struct consumer_slot {
+	_Alignas(64) _Atomic uint64_t received;
+};
+
+/* State of the point being measured */
+struct scaling_run {
+	enum scaling_suite suite;
+	unsigned int producers;
+	unsigned int consumers;
+	atomic_bool stop;
+	pthread_barrier_t barrier;
+	
+	struct ring_buffer *ring;
+	struct object_pool *pool;
+	struct thread_pool *thread_pool;
+	struct event_processor *ep;
+	int lanes[MAX_THREADS];
+	
+	struct consumer_slot slots[MAX_THREADS];
+	_Atomic unsigned int slots_used;
+	struct hdr_histogram *latency;
+};
+
+struct producer_arg {
+	struct scaling_run *run;
+	unsigned int index;
+};
+
+/* Results of one point */
+struct scaling_result {
+	uint64_t ops;
+	double seconds;
+	double p50_ns;
+	double p99_ns;
+	double p999_ns;
+	int64_t cache_misses;         /* -1 if not counted */
+};
+
+static struct scaling_run g_run;
+
+/* Slot of the calling consumer; pool and processor threads take one on first use */
+static struct consumer_slot *consumer_slot(struct scaling_run *run)
+{
+	static __thread struct scaling_run *slot_run;
+	static __thread struct consumer_slot *slot;
+	
+	if (slot_run != run) {
+		unsigned int i = atomic_fetch_add(&run->slots_used, 1);
+		
+		slot = &run->slots[i < MAX_THREADS ? i : MAX_THREADS - 1];
+		slot_run = run;
+	}
+	return slot;
+}
+
+/* Count an item received, timing it if it carries its hand-off time */
+static inline void receive(struct scaling_run *run, uintptr_t stamp)
+{
+	struct consumer_slot *slot = consumer_slot(run);
+	
+	if (stamp > UNTIMED)
+		hdr_histogram_record(run->latency, (double)(benchmark_get_time_ns() - stamp));
+	atomic_store_explicit(&slot->received,
+	                      atomic_load_explicit(&slot->received, memory_order_relaxed) + 1,
+	                      memory_order_relaxed);
+}
+
+static inline uintptr_t next_stamp(uint64_t *sent)
+{
+	return (*sent)++ % LATENCY_SAMPLE ? UNTIMED : (uintptr_t)benchmark_get_time_ns();
+}
+
+static void work_item(void *arg);
+
+static void *producer_thread(void *arg)
+{
+	struct producer_arg *p = arg;
+	struct scaling_run *run = p->run;
+	struct nlmon_event event = { 0 };
+	uint64_t sent = 0;
+	
+	pthread_barrier_wait(&run->barrier);
+	
+	while (!atomic_load_explicit(&run->stop, memory_order_relaxed)) {
+		uintptr_t stamp = next_stamp(&sent);
+		bool queued;
+		
+		/* A full queue is retried, producers wait as a receive thread would */
+		do {
+			switch (run->suite) {
+			case SUITE_RING:
+				queued = ring_buffer_enqueue(run->ring, (void *)stamp);
+				break;
+			case SUITE_POOL: {
+				uintptr_t *obj = object_pool_alloc(run->pool);
+				
+				if (!obj) {
+					queued = false;
+					break;
+				}
+				*obj = stamp;
+				queued = ring_buffer_enqueue(run->ring, obj);
+				if (!queued)
+					object_pool_free(run->pool, obj);
+				break;
+			}
+			case SUITE_THREAD_POOL:
+				queued = thread_pool_submit(run->thread_pool, work_item, (void *)stamp,
+				                            PRIORITY_NORMAL);
+				break;
+			default:
+				event.timestamp = stamp;
+				queued = event_processor_submit_lane(run->ep, run->lanes[p->index], &event);
+				break;
+			}
+			if (!queued)
+				sched_yield();
+		} while (!queued && !atomic_load_explicit(&run->stop, memory_order_relaxed));
+	}
+	return NULL;
+}
+
+static void *consumer_thread(void *arg)
+{
+	struct scaling_run *run = arg;
+	void *items[CONSUMER_BULK];
+	
+	pthread_barrier_wait(&run->barrier);
+	
+	while (!atomic_load_explicit(&run->stop, memory_order_relaxed)) {
+		size_t n = ring_buffer_dequeue_bulk(run->ring, items, CONSUMER_BULK);
+		
+		if (!n) {
+			sched_yield();
+			continue;
+		}
+		for (size_t i = 0; i < n; i++) {
+			if (run->suite == SUITE_POOL) {
+				uintptr_t *obj = items[i];
+				
+				receive(run, *obj);
+				object_pool_free(run->pool, obj);
+			} else {
+				receive(run, (uintptr_t)items[i]);
+			}
+		}
+	}
+	
+	/* Leave nothing in the ring for the next point */
+	if (run->suite == SUITE_POOL) {
+		void *obj;
+		
+		while ((obj = ring_buffer_dequeue(run->ring)) != NULL)
+			object_pool_free(run->pool, obj);
+	}
+	return NULL;
+}
+
+static void work_item(void *arg)
+{
+	receive(&g_run, (uintptr_t)arg);
+}
+
+static void handle_event(struct nlmon_event *event, void *ctx)
+{
+	receive(ctx, event->timestamp);
+}
+
+/* Cache misses of this process and the threads it creates after the call */
+static int cache_miss_counter_open(void)
+{
+	struct perf_event_attr attr;
+	
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Threads count once they have exited */
+static int64_t cache_miss_counter_close(int fd)
+{
+	uint64_t value;
+	ssize_t ret;
+	
+	if (fd < 0)
+		return -1;
+	ret = read(fd, &value, sizeof(value));
+	close(fd);
+	return ret == sizeof(value) ? (int64_t)value : -1;
+}
+
+static int setup_suite(struct scaling_run *run)
+{
+	switch (run->suite) {
+	case SUITE_RING:
+		run->ring = ring_buffer_create_mpmc(RING_CAPACITY);
+		return run->ring ? 0 : -1;
+	case SUITE_POOL:
+		run->ring = ring_buffer_create_mpmc(RING_CAPACITY);
+		run->pool = object_pool_create(POOL_OBJECT_SIZE, RING_CAPACITY * 2);
+		return run->ring && run->pool ? 0 : -1;
+	case SUITE_THREAD_POOL:
+		run->thread_pool = thread_pool_create(run->consumers, RING_CAPACITY);
+		return run->thread_pool ? 0 : -1;
+	default: {
+		struct event_processor_config config = {
+			.ring_buffer_size = RING_CAPACITY,
+			.thread_pool_size = run->consumers,
+			.work_queue_size = 4096,
+		};
+			
+		run->ep = event_processor_create(&config);
+		if (!run->ep || event_processor_register_handler(run->ep, handle_event, run) < 0)
+			return -1;
+		/* A lane of its own for each producer, lane 0 for the first */
+		run->lanes[0] = 0;
+		for (unsigned int i = 1; i < run->producers; i++) {
+			run->lanes[i] = event_processor_add_lane(run->ep, RING_CAPACITY / 4);
+			if (run->lanes[i] < 0)
+				return -1;
+		}
+		return 0;
+	}
+	}
+}
+
+static void teardown_suite(struct scaling_run *run)
+{
+	if (run->thread_pool)
+		thread_pool_destroy(run->thread_pool, true);
+	if (run->ep)
+		event_processor_destroy(run->ep, true);
+	if (run->pool)
+		object_pool_destroy(run->pool);
+	if (run->ring)
+		ring_buffer_destroy(run->ring);
+	run->thread_pool = NULL;
+	run->ep = NULL;
+	run->pool = NULL;
+	run->ring = NULL;
+}
+
+static uint64_t received(struct scaling_run *run)
+{
+	uint64_t total = 0;
+	
+	for (unsigned int i = 0; i < MAX_THREADS; i++)
+		total += atomic_load_explicit(&run->slots[i].received, memory_order_relaxed);
+	return total;
+}
+
+static int run_point(enum scaling_suite suite, unsigned int producers, unsigned int consumers,
+                     double seconds, struct scaling_result *result)
+{
+	struct scaling_run *run = &g_run;
+	pthread_t producer_threads[MAX_THREADS], consumer_threads[MAX_THREADS];
+	struct producer_arg args[MAX_THREADS];
+	bool own_consumers = suite == SUITE_RING || suite == SUITE_POOL;
+	uint64_t start, before, ops;
+	unsigned int i;
+	int perf_fd, ret = 0;
+	
+	memset(run, 0, sizeof(*run));
+	run->suite = suite;
+	run->producers = producers;
+	run->consumers = consumers;
+	run->latency = hdr_histogram_create(HDR_HISTOGRAM_DEFAULT_SCHEMA);
+	if (!run->latency)
+		return -1;
+	
+	/* Before any thread of the point exists, so all are counted */
+	perf_fd = cache_miss_counter_open();
+	
+	if (setup_suite(run) < 0) {
+		ret = -1;
+		goto out;
+	}
+	
+	pthread_barrier_init(&run->barrier, NULL, producers + (own_consumers ? consumers : 0) + 1);
+	for (i = 0; i < producers; i++) {
+		args[i].run = run;
+		args[i].index = i;
+		pthread_create(&producer_threads[i], NULL, producer_thread, &args[i]);
+	}
+	if (own_consumers) {
+		for (i = 0; i < consumers; i++)
+			pthread_create(&consumer_threads[i], NULL, consumer_thread, run);
+	}
+	
+	pthread_barrier_wait(&run->barrier);
+	before = received(run);
+	start = benchmark_get_time_ns();
+	usleep((useconds_t)(seconds * 1e6));
+	ops = received(run) - before;
+	result->seconds = (benchmark_get_time_ns() - start) / 1e9;
+	atomic_store(&run->stop, true);
+	
+	for (i = 0; i < producers; i++)
+		pthread_join(producer_threads[i], NULL);
+	if (own_consumers) {
+		for (i = 0; i < consumers; i++)
+			pthread_join(consumer_threads[i], NULL);
+	}
+	pthread_barrier_destroy(&run->barrier);
+	
+	result->ops = ops;
+	result->p50_ns = hdr_histogram_quantile(run->latency, 0.5);
+	result->p99_ns = hdr_histogram_quantile(run->latency, 0.99);
+	result->p999_ns = hdr_histogram_quantile(run->latency, 0.999);
+	
+out:
+	teardown_suite(run);
+	result->cache_misses = cache_miss_counter_close(perf_fd);
+	hdr_histogram_destroy(run->latency);
+	return ret;
+}
+
+static int parse_suites(const char *spec, bool *enabled)
+{
+	char *copy = strdup(spec), *saveptr = NULL, *name;
+	int ret = 0;
+	
+	if (!copy)
+		return -1;
+	for (name = strtok_r(copy, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr)) {
+		int i;
+		
+		for (i = 0; i < SUITE_COUNT && strcmp(name, suite_names[i]); i++)
+			;
+		if (i == SUITE_COUNT) {
+			ret = -1;
+			break;
+		}
+		enabled[i] = true;
+	}
+	free(copy);
+	return ret;
+}
+
+static void write_result(FILE *out, enum scaling_suite suite, unsigned int producers,
+                         unsigned int consumers, const struct scaling_result *r)
+{
+	fprintf(out, "{\"benchmark\":\"scaling\",\"suite\":\"%s\",\"time\":%lld,"
+	        "\"cpus\":%ld,\"producers\":%u,\"consumers\":%u,\"seconds\":%.3f,"
+	        "\"ops\":%llu,\"ops_per_sec\":%.0f,\"p50_ns\":%.0f,\"p99_ns\":%.0f,"
+	        "\"p999_ns\":%.0f,\"cache_misses\":",
+	        suite_names[suite], (long long)time(NULL), sysconf(_SC_NPROCESSORS_ONLN),
+	        producers, consumers, r->seconds, (unsigned long long)r->ops,
+	        r->ops / r->seconds, r->p50_ns, r->p99_ns, r->p999_ns);
+	if (r->cache_misses < 0)
+		fprintf(out, "null,\"cache_misses_per_op\":null}\n");
+	else
+		fprintf(out, "%lld,\"cache_misses_per_op\":%.2f}\n", (long long)r->cache_misses,
+		        r->ops ? (double)r->cache_misses / r->ops : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+	bool enabled[SUITE_COUNT] = { false };
+	unsigned int counts[32], ncounts = 0, max_threads;
+	const char *output = NULL;
+	double seconds = 1;
+	FILE *out = NULL;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt, ret = 0;
+	
+	max_threads = cpus > 0 ? (unsigned int)cpus : 1;
+	
+	while ((opt = getopt(argc, argv, "d:t:s:o:")) != -1) {
+		switch (opt) {
+		case 'd':
+			seconds = atof(optarg);
+			break;
+		case 't':
+			max_threads = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			if (parse_suites(optarg, enabled) < 0) {
+				fprintf(stderr, "Unknown suite in %s\n", optarg);
+				return 2;
+			}
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			fprintf(stderr, USAGE, argv[0]);
+			return 2;
+		}
+	}
+	if (optind != argc || seconds <= 0 || !max_threads || max_threads > MAX_THREADS / 2) {
+		fprintf(stderr, USAGE, argv[0]);
+		return 2;
+	}
+	if (!enabled[SUITE_RING] && !enabled[SUITE_POOL] && !enabled[SUITE_THREAD_POOL] &&
+	    !enabled[SUITE_EVENT_PROCESSOR])
+		memset(enabled, true, sizeof(enabled));
+	
+	if (output) {
+		out = fopen(output, "a");
+		if (!out) {
+			fprintf(stderr, "%s: %s\n", output, strerror(errno));
+			return 1;
+		}
+	}
+	
+	for (unsigned int n = 1; n < max_threads; n *= 2)
+		counts[ncounts++] = n;
+	counts[ncounts++] = max_threads;
+	
+	printf("=== Scaling: %ld CPUs, %.1f sec per point ===\n", cpus, seconds);
+	
+	for (int s = 0; s < SUITE_COUNT; s++) {
+		if (!enabled[s])
+			continue;
+		
+		printf("\n%-16s %5s %5s %14s %10s %10s %10s %12s\n", suite_names[s], "prod", "cons",
+		       "ops/sec", "p50 ns", "p99 ns", "p99.9 ns", "misses/op");
+		for (unsigned int p = 0; p < ncounts; p++) {
+			for (unsigned int c = 0; c < ncounts; c++) {
+				struct scaling_result r;
+				
+				if (run_point(s, counts[p], counts[c], seconds, &r) < 0) {
+					fprintf(stderr, "%s: setting up %u/%u failed\n", suite_names[s],
+					        counts[p], counts[c]);
+					ret = 1;
+					continue;
+				}
+				
+				printf("%-16s %5u %5u %14.0f %10.0f %10.0f %10.0f ", "", counts[p],
+				       counts[c], r.ops / r.seconds, r.p50_ns, r.p99_ns, r.p999_ns);
+				if (r.cache_misses < 0)
+					printf("%12s\n", "-");
+				else
+					printf("%12.2f\n", r.ops ? (double)r.cache_misses / r.ops : 0.0);
+				fflush(stdout);
+				
+				if (out)
+					write_result(out, s, counts[p], counts[c], &r);
+			}
+		}
+	}
+	
+	if (out)
+		fclose(out);
+	return ret;
+}
@@ -0,0 +1,301 @@
+/* bench_startup.c - Startup and configuration reload latency, per phase
+ *
+ * Runs nlmon -Z against generated configurations of increasing size:
+ * each run starts up, prints how long every phase of main and of the
+ * startup graph took, times the requested reloads of its configuration
+ * and exits. The median and worst of every phase over the runs are
+ * reported per configuration size, reload stages over all reloads.
+ *
+ * Usage:
+ *   bench_startup [-n nlmon] [-r runs] [-z reloads] [-o results] [-- nlmon args]
+ *
+ *   -n  nlmon binary to run (default ./nlmon)
+ *   -r  Runs per configuration size (default 5)
+ *   -z  Reloads timed per run (default 5)
+ *   -o  Append results to a file, one JSON object per phase and size,
+ *       for tracking across builds
+ *
+ * Arguments after -- are passed to nlmon, e.g. -- -g -T 0 to include
+ * the subsystems and receive threads those options start. Without
+ * CAP_NET_ADMIN the phases that need it fail fast and time little.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "benchmark_framework.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define USAGE "Usage: %s [-n nlmon] [-r runs] [-z reloads] [-o results] [-- nlmon args]\n"
+
+#define MAX_PHASES 64
+#define MAX_SAMPLES 1024
+#define MAX_ARGS 64
+
+/* A run that takes longer is stuck, not slow */
+#define RUN_TIMEOUT_SEC 30
+
+/* Interface patterns and hooks of each generated configuration */
+static const int config_rules[] = { 0, 100, 1000, 10000 };
+#define CONFIG_SIZES (int)(sizeof(config_rules) / sizeof(config_rules[0]))
+
+struct phase {
+	char name[64];
+	double samples[MAX_SAMPLES];
+	int count;
+};
+
+static struct phase phases[MAX_PHASES];
+static int phase_count;
+
+static int write_config(const char *path, int rules)
+{
+	FILE *f = fopen(path, "w");
+	
+	if (!f)
+		return -1;
+	
+	fprintf(f, "nlmon:\n  core:\n    buffer_size: 320KB\n    max_events: 10000\n");
+	fprintf(f, "  monitoring:\n    interfaces:\n      include:\n        - \"*\"\n");
+	for (int i = 0; i < rules; i++)
+		fprintf(f, "        - \"veth%d*\"\n", i);
+	if (rules)
+		fprintf(f, "  integration:\n    hooks:\n");
+	for (int i = 0; i < rules; i++) {
+		fprintf(f, "      - name: hook%d\n", i);
+		fprintf(f, "        script: /usr/lib/nlmon/hooks/hook%d.sh\n", i);
+		fprintf(f, "        condition: 'interface == \"eth%d\" && msg_type == 16'\n", i);
+		fprintf(f, "        timeout_ms: 5000\n        enabled: true\n");
+	}
+	
+	fclose(f);
+	return 0;
+}
+
+/* reload.N and reload.N.stage are pooled over the reloads of a run */
+static struct phase *find_phase(const char *label)
+{
+	char name[64];
+	const char *stage;
+	
+	if (strncmp(label, "reload.", 7) == 0) {
+		stage = strchr(label + 7, '.');
+		snprintf(name, sizeof(name), "reload%s", stage ? stage : "");
+	} else {
+		snprintf(name, sizeof(name), "%s", label);
+	}
+	
+	for (int i = 0; i < phase_count; i++) {
+		if (strcmp(phases[i].name, name) == 0)
+			return &phases[i];
+	}
+	if (phase_count == MAX_PHASES)
+		return NULL;
+	snprintf(phases[phase_count].name, sizeof(phases[phase_count].name), "%s", name);
+	phases[phase_count].count = 0;
+	return &phases[phase_count++];
+}
+
+/* One run of nlmon -Z, its phases added to the samples */
+static int run_nlmon(char **argv)
+{
+	char line[256], label[64];
+	double start, took;
+	int pipefd[2], status, lines = 0;
+	struct phase *phase;
+	pid_t pid;
+	FILE *in;
+	
+	if (pipe(pipefd) < 0)
+		return -1;
+	
+	pid = fork();
+	if (pid < 0) {
+		close(pipefd[0]);
+		close(pipefd[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+	
+		dup2(pipefd[1], STDOUT_FILENO);
+		if (null >= 0)
+			dup2(null, STDERR_FILENO);
+		close(pipefd[0]);
+		close(pipefd[1]);
+		alarm(RUN_TIMEOUT_SEC);
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+	
+	close(pipefd[1]);
+	in = fdopen(pipefd[0], "r");
+	if (!in) {
+		close(pipefd[0]);
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), in)) {
+		if (sscanf(line, "%63s %lf %lf", label, &start, &took) != 3)
+			continue;
+		phase = find_phase(label);
+		if (phase && phase->count < MAX_SAMPLES)
+			phase->samples[phase->count++] = took;
+		lines++;
+	}
+	fclose(in);
+	
+	if (waitpid(pid, &status, 0) < 0)
+		return -1;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !lines) {
+		fprintf(stderr, "%s exited %s %d after %d phases\n", argv[0],
+		        WIFEXITED(status) ? "with" : "on signal",
+		        WIFEXITED(status) ? WEXITSTATUS(status) : WTERMSIG(status), lines);
+		return -1;
+	}
+	return 0;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	
+	return (x > y) - (x < y);
+}
+
+static void report(int rules, int runs, FILE *out)
+{
+	printf("\n%d interface patterns and hooks, %d runs\n", rules, runs);
+	printf("  %-28s %10s %10s\n", "phase", "median_ms", "max_ms");
+	
+	for (int i = 0; i < phase_count; i++) {
+		struct phase *p = &phases[i];
+		double median, max;
+	
+		if (!p->count)
+			continue;
+		qsort(p->samples, p->count, sizeof(p->samples[0]), compare_double);
+		median = p->samples[p->count / 2];
+		max = p->samples[p->count - 1];
+		printf("  %-28s %10.3f %10.3f\n", p->name, median, max);
+	
+		if (out)
+			fprintf(out, "{\"benchmark\":\"startup\",\"rules\":%d,\"phase\":\"%s\","
+			        "\"time\":%lld,\"runs\":%d,\"samples\":%d,\"median_ms\":%.3f,"
+			        "\"max_ms\":%.3f}\n", rules, p->name, (long long)time(NULL), runs,
+			        p->count, median, max);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *nlmon = "./nlmon";
+	const char *output = NULL;
+	char dir[] = "/tmp/nlmon_bench_startup.XXXXXX";
+	char path[CONFIG_SIZES][64] = { { 0 } };
+	char reloads_arg[16];
+	char *args[MAX_ARGS];
+	int runs = 5, reloads = 5;
+	int opt, nargs, ret = 0;
+	FILE *out = NULL;
+	
+	while ((opt = getopt(argc, argv, "n:r:z:o:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nlmon = optarg;
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		case 'z':
+			reloads = atoi(optarg);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			fprintf(stderr, USAGE, argv[0]);
+			return 2;
+		}
+	}
+	if (runs <= 0 || reloads < 0 || argc - optind > MAX_ARGS - 6 ||
+	    (size_t)runs * (reloads > 0 ? reloads : 1) > MAX_SAMPLES) {
+		fprintf(stderr, USAGE, argv[0]);
+		return 2;
+	}
+	
+	if (!mkdtemp(dir)) {
+		fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+		return 1;
+	}
+	for (int s = 0; s < CONFIG_SIZES; s++) {
+		snprintf(path[s], sizeof(path[s]), "%s/config_%d.yaml", dir, config_rules[s]);
+		if (write_config(path[s], config_rules[s]) < 0) {
+			fprintf(stderr, "%s: %s\n", path[s], strerror(errno));
+			ret = 1;
+			goto out;
+		}
+	}
+	
+	if (output) {
+		out = fopen(output, "a");
+		if (!out) {
+			fprintf(stderr, "%s: %s\n", output, strerror(errno));
+			ret = 1;
+			goto out;
+		}
+	}
+	
+	printf("\n");
+	printf("===============================================\n");
+	printf("  Benchmark Suite: Startup and Reload\n");
+	printf("===============================================\n");
+	printf("%s, %d runs of %d reloads per configuration\n", nlmon, runs, reloads);
+	
+	snprintf(reloads_arg, sizeof(reloads_arg), "%d", reloads);
+	for (int s = 0; s < CONFIG_SIZES && !ret; s++) {
+		nargs = 0;
+		args[nargs++] = (char *)nlmon;
+		args[nargs++] = "-C";
+		args[nargs++] = path[s];
+		args[nargs++] = "-Z";
+		args[nargs++] = reloads_arg;
+		for (int i = optind; i < argc; i++)
+			args[nargs++] = argv[i];
+		args[nargs] = NULL;
+	
+		phase_count = 0;
+		for (int r = 0; r < runs; r++) {
+			if (run_nlmon(args) < 0) {
+				ret = 1;
+				break;
+			}
+		}
+		if (!ret)
+			report(config_rules[s], runs, out);
+	}
+	
+	printf("\n");
+	printf("===============================================\n");
+	printf("  Benchmarks Complete\n");
+	printf("===============================================\n");
+	printf("\n");
+	
+	if (out)
+		fclose(out);
+out:
+	for (int s = 0; s < CONFIG_SIZES; s++) {
+		if (path[s][0])
+			unlink(path[s]);
+	}
+	rmdir(dir);
+	return ret;
+}
@@ -0,0 +1,730 @@
+/* bench_storage.c - Storage throughput and query latency benchmark
+ *
+ * Measures the storage paths of an event:
+ *   insert     sustained storage_db inserts per batch_size, direct with
+ *              and without WAL and through the async writer
+ *   query      storage_db query latency per db_query_filter shape as the
+ *              history grows
+ *   buffer     storage_buffer_query latency, idle and while a writer
+ *              adds events at full speed
+ *   audit      audit_log write rates per batch, sync and checkpoint
+ *              setting, and full and range verification rates
+ *   retention  storage_db_delete_before/_delete_oldest time, one table
+ *              and partitioned
+ *
+ * Usage:
+ *   bench_storage [-s suites] [-d seconds] [-H sizes] [-R rows] [-r reps]
+ *                 [-D directory]
+ *
+ *   -s  Comma separated suites (default all)
+ *   -d  Longest run of one insert or audit configuration (default 2)
+ *   -H  History sizes for queries (default 10000,100000,1000000)
+ *   -R  Rows for retention (default 1000000), e.g.
+ *       10000000,100000000,1000000000 on a machine with the disk for it,
+ *       about 100 bytes a row
+ *   -r  Repetitions of each query (default 50)
+ *   -D  Directory for the files (default /tmp), removed afterwards
+ */
+
+#include "benchmark_framework.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "event_processor.h"
+#include "storage_db.h"
+#include "storage_buffer.h"
+#include "audit_log.h"
+#include "hdr_histogram.h"
+
+#define USAGE "Usage: %s [-s insert,query,buffer,audit,retention] [-d seconds] [-H sizes]\n" \
+              "       [-R rows] [-r reps] [-D directory]\n"
+
+#define MAX_SIZES 8
+#define INTERFACES 64
+#define BUFFER_CAPACITY 100000
+#define FILL_BATCH 4096
+
+enum storage_suite {
+	SUITE_INSERT,
+	SUITE_QUERY,
+	SUITE_BUFFER,
+	SUITE_AUDIT,
+	SUITE_RETENTION,
+	SUITE_COUNT
+};
+
+static const char *const suite_names[SUITE_COUNT] = {
+	[SUITE_INSERT] = "insert",
+	[SUITE_QUERY] = "query",
+	[SUITE_BUFFER] = "buffer",
+	[SUITE_AUDIT] = "audit",
+	[SUITE_RETENTION] = "retention",
+};
+
+struct bench_options {
+	double seconds;
+	size_t history[MAX_SIZES];
+	size_t nhistory;
+	size_t rows[MAX_SIZES];
+	size_t nrows;
+	unsigned int reps;
+	char dir[256];
+};
+
+static const uint16_t message_types[] = { 16, 17, 20, 21, 24, 25, 28, 29 };
+
+/* Event @i of a history, timestamps 1 apart */
+static void make_event(struct nlmon_event *evt, uint64_t i)
+{
+	memset(evt, 0, sizeof(*evt));
+	evt->timestamp = i + 1;
+	evt->sequence = i;
+	evt->event_type = 1 + i % 4;
+	evt->message_type = message_types[i % (sizeof(message_types) / sizeof(message_types[0]))];
+	evt->netlink.msg_type = evt->message_type;
+	snprintf(evt->interface, sizeof(evt->interface), "nlgen%04u",
+	         (unsigned int)(1 + (i * 7) % INTERFACES));
+}
+
+static void remove_db(const char *path)
+{
+	char other[320];
+	
+	unlink(path);
+	snprintf(other, sizeof(other), "%s-wal", path);
+	unlink(other);
+	snprintf(other, sizeof(other), "%s-shm", path);
+	unlink(other);
+}
+
+static uint64_t file_size(const char *path)
+{
+	struct stat st;
+	
+	return stat(path, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+static struct storage_db *open_db(const char *path, size_t batch_size, bool wal, bool async,
+                                  uint64_t partition_span)
+{
+	struct storage_db_config config = {
+		.db_path = path,
+		.batch_size = batch_size,
+		.cache_size_kb = 16384,
+		.enable_wal = wal,
+		.busy_timeout_ms = 5000,
+		.partition_span = partition_span,
+		.async_writer = async,
+		.commit_count = async ? batch_size : 0,
+	};
+	
+	remove_db(path);
+	return storage_db_open(&config);
+}
+
+/* Insert events @from to @to, waiting for room while an async queue is full */
+static bool fill_db(struct storage_db *db, uint64_t from, uint64_t to, uint64_t deadline_ns)
+{
+	struct storage_db_writer_stats stats;
+	struct nlmon_event evt;
+	
+	for (uint64_t i = from; i < to; i++) {
+		make_event(&evt, i);
+		while (!storage_db_insert(db, &evt)) {
+			/* Without an async writer the insert itself failed */
+			if (!storage_db_get_writer_stats(db, &stats))
+				return false;
+			usleep(100);
+		}
+		if (deadline_ns && (i & 255) == 0 && benchmark_get_time_ns() > deadline_ns)
+			return true;
+	}
+	return true;
+}
+
+static void run_insert(const struct bench_options *opts)
+{
+	static const size_t batch_sizes[] = { 1, 16, 128, 1024 };
+	static const struct {
+		const char *name;
+		bool wal;
+		bool async;
+	} modes[] = {
+		{ "direct", false, false },
+		{ "direct+wal", true, false },
+		{ "async+wal", true, true },
+	};
+	char path[300];
+	
+	snprintf(path, sizeof(path), "%s/insert.db", opts->dir);
+	printf("\n=== storage_db inserts, up to %.1f sec each ===\n", opts->seconds);
+	printf("%-12s %6s %12s %14s %10s\n", "mode", "batch", "events", "events/sec", "MB");
+	
+	for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		for (size_t b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); b++) {
+			struct storage_db *db = open_db(path, batch_sizes[b], modes[m].wal,
+			                                modes[m].async, 0);
+			uint64_t start, end, total = 0;
+			double elapsed;
+			
+			if (!db) {
+				fprintf(stderr, "Failed to open %s\n", path);
+				return;
+			}
+			
+			start = benchmark_get_time_ns();
+			end = start + (uint64_t)(opts->seconds * 1e9);
+			while (benchmark_get_time_ns() < end) {
+				if (!fill_db(db, total, total + 1024, end))
+					break;
+				total += 1024;
+			}
+			storage_db_flush(db);
+			elapsed = (benchmark_get_time_ns() - start) / 1e9;
+			storage_db_get_stats(db, &total, NULL, NULL);
+			storage_db_close(db);
+			
+			printf("%-12s %6zu %12llu %14.0f %10.1f\n", modes[m].name, batch_sizes[b],
+			       (unsigned long long)total, total / elapsed, file_size(path) / 1e6);
+			remove_db(path);
+		}
+	}
+}
+
+/* Query shapes, @size events in the history */
+struct query_shape {
+	const char *name;
+	void (*setup)(struct db_query_filter *filter, size_t size, unsigned int rep);
+};
+
+static void shape_latest(struct db_query_filter *f, size_t size, unsigned int rep)
+{
+	f->limit = 100;
+	f->descending = true;
+}
+
+static void shape_interface(struct db_query_filter *f, size_t size, unsigned int rep)
+{
+	static char name[16];
+	
+	snprintf(name, sizeof(name), "nlgen%04u", 1 + rep % INTERFACES);
+	f->interface_pattern = name;
+	f->limit = 100;
+	f->descending = true;
+}
+
+static void shape_prefix(struct db_query_filter *f, size_t size, unsigned int rep)
+{
+	f->interface_pattern = "nlgen00%";
+	f->limit = 100;
+	f->descending = true;
+}
+
+static void shape_event_type(struct db_query_filter *f, size_t size, unsigned int rep)
+{
+	f->event_type = 1 + rep % 4;
+	f->limit = 100;
+}
+
+static void shape_message_type(struct db_query_filter *f, size_t size, unsigned int rep)
+{
+	f->message_type = message_types[rep % (sizeof(message_types) / sizeof(message_types[0]))];
+	f->limit = 100;
+}
+
+/* A window of 1% of the history */
+static void shape_time_range(struct db_query_filter *f, size_t size, unsigned int rep)
+{
+	uint64_t span = size / 100 ? size / 100 : 1;
+	
+	f->start_time = 1 + (rep * 7919ULL) % (size - span + 1);
+	f->end_time = f->start_time + span - 1;
+}
+
+static void shape_interface_time(struct db_query_filter *f, size_t size, unsigned int rep)
+{
+	shape_time_range(f, size, rep);
+	shape_interface(f, size, rep);
+	f->limit = 0;
+	f->descending = false;
+}
+
+static void shape_deep_offset(struct db_query_filter *f, size_t size, unsigned int rep)
+{
+	f->offset = size / 2;
+	f->limit = 100;
+}
+
+static const struct query_shape query_shapes[] = {
+	{ "latest 100", shape_latest },
+	{ "interface", shape_interface },
+	{ "prefix%", shape_prefix },
+	{ "event_type", shape_event_type },
+	{ "message_type", shape_message_type },
+	{ "time 1%", shape_time_range },
+	{ "iface+time", shape_interface_time },
+	{ "offset/2", shape_deep_offset },
+};
+
+static void count_row(struct nlmon_event *event, void *ctx)
+{
+	(*(uint64_t *)ctx)++;
+}
+
+static void print_latency_header(const char *first)
+{
+	printf("%-14s %10s %10s %10s %10s %10s\n", first, "rows", "p50 us", "p99 us",
+	       "max us", "queries/s");
+}
+
+static void print_latency(const char *name, struct hdr_histogram *h, uint64_t rows)
+{
+	uint64_t n = hdr_histogram_count(h);
+	
+	printf("%-14s %10.0f %10.1f %10.1f %10.1f %10.0f\n", name, n ? (double)rows / n : 0.0,
+	       hdr_histogram_quantile(h, 0.5) / 1e3, hdr_histogram_quantile(h, 0.99) / 1e3,
+	       hdr_histogram_max(h) / 1e3, n ? 1e9 / (hdr_histogram_sum(h) / n) : 0.0);
+}
+
+static void run_query(const struct bench_options *opts)
+{
+	struct storage_db *db;
+	char path[300];
+	uint64_t filled = 0;
+	
+	snprintf(path, sizeof(path), "%s/query.db", opts->dir);
+	db = open_db(path, FILL_BATCH, true, false, 0);
+	if (!db) {
+		fprintf(stderr, "Failed to open %s\n", path);
+		return;
+	}
+	
+	for (size_t s = 0; s < opts->nhistory; s++) {
+		size_t size = opts->history[s];
+		
+		/* Histories grow, each size adds to the previous */
+		fill_db(db, filled, size, 0);
+		storage_db_flush(db);
+		storage_db_analyze(db);
+		filled = size;
+		
+		printf("\n=== storage_db queries, %zu events, %u repetitions ===\n", size, opts->reps);
+		print_latency_header("shape");
+		
+		for (size_t q = 0; q < sizeof(query_shapes) / sizeof(query_shapes[0]); q++) {
+			struct hdr_histogram *h = hdr_histogram_create(HDR_HISTOGRAM_DEFAULT_SCHEMA);
+			uint64_t rows = 0;
+			
+			if (!h)
+				break;
+			for (unsigned int r = 0; r < opts->reps; r++) {
+				struct db_query_filter filter = { 0 };
+				uint64_t start;
+				
+				query_shapes[q].setup(&filter, size, r);
+				start = benchmark_get_time_ns();
+				storage_db_query(db, &filter, count_row, &rows);
+				hdr_histogram_record(h, benchmark_get_time_ns() - start);
+			}
+			print_latency(query_shapes[q].name, h, rows);
+			hdr_histogram_destroy(h);
+		}
+		
+		/* Counting reads every match, the cost of a dashboard summary */
+		{
+			struct hdr_histogram *h = hdr_histogram_create(HDR_HISTOGRAM_DEFAULT_SCHEMA);
+			uint64_t rows = 0;
+			
+			for (unsigned int r = 0; h && r < opts->reps; r++) {
+				struct db_query_filter filter = { 0 };
+				uint64_t start;
+				int n;
+				
+				shape_interface(&filter, size, r);
+				filter.limit = 0;
+				start = benchmark_get_time_ns();
+				n = storage_db_count(db, &filter);
+				hdr_histogram_record(h, benchmark_get_time_ns() - start);
+				rows += n > 0 ? n : 0;
+			}
+			if (h)
+				print_latency("count iface", h, rows);
+			hdr_histogram_destroy(h);
+		}
+	}
+	
+	storage_db_close(db);
+	remove_db(path);
+}
+
+struct buffer_writer {
+	struct storage_buffer *sb;
+	atomic_bool stop;
+	_Atomic uint64_t added;
+};
+
+static void *buffer_writer_thread(void *arg)
+{
+	struct buffer_writer *w = arg;
+	struct nlmon_event evt;
+	
+	for (uint64_t i = BUFFER_CAPACITY; !atomic_load_explicit(&w->stop, memory_order_relaxed); i++) {
+		make_event(&evt, i);
+		storage_buffer_add(w->sb, &evt);
+		atomic_store_explicit(&w->added, i + 1 - BUFFER_CAPACITY, memory_order_relaxed);
+	}
+	return NULL;
+}
+
+static void count_buffer_row(struct nlmon_event *event, void *ctx)
+{
+	(*(uint64_t *)ctx)++;
+}
+
+/* Query shapes of the buffer, as the CLI and web history pages filter */
+static void buffer_filter(struct buffer_query_filter *f, int shape, unsigned int rep,
+                          uint64_t newest)
+{
+	static char name[16];
+	
+	memset(f, 0, sizeof(*f));
+	switch (shape) {
+	case 0:
+		snprintf(name, sizeof(name), "nlgen%04u", 1 + rep % INTERFACES);
+		f->interface_pattern = name;
+		break;
+	case 1:
+		f->event_type = 1 + rep % 4;
+		f->max_results = 100;
+		break;
+	case 2:
+		f->message_type = message_types[rep % (sizeof(message_types) / sizeof(message_types[0]))];
+		f->max_results = 100;
+		break;
+	default:
+		f->start_time = newest > BUFFER_CAPACITY / 100 ? newest - BUFFER_CAPACITY / 100 : 0;
+		break;
+	}
+}
+
+static void run_buffer(const struct bench_options *opts)
+{
+	static const char *const shapes[] = { "interface", "event_type", "message_type", "newest 1%" };
+	static const bool indexed_modes[] = { false, true };
+	struct nlmon_event evt;
+	
+	for (size_t m = 0; m < 2; m++) {
+		for (int busy = 0; busy < 2; busy++) {
+			struct storage_buffer *sb = indexed_modes[m] ?
+			                            storage_buffer_create_indexed(BUFFER_CAPACITY) :
+			                            storage_buffer_create(BUFFER_CAPACITY);
+			struct buffer_writer writer = { .sb = sb };
+			pthread_t thread;
+			uint64_t start = 0;
+			
+			if (!sb)
+				return;
+			for (uint64_t i = 0; i < BUFFER_CAPACITY; i++) {
+				make_event(&evt, i);
+				storage_buffer_add(sb, &evt);
+			}
+			
+			printf("\n=== storage_buffer%s queries, %d events, %s ===\n",
+			       indexed_modes[m] ? " (indexed)" : "", BUFFER_CAPACITY,
+			       busy ? "one writer adding" : "no writer");
+			print_latency_header("shape");
+			
+			if (busy) {
+				pthread_create(&thread, NULL, buffer_writer_thread, &writer);
+				start = benchmark_get_time_ns();
+			}
+			
+			for (int q = 0; q < 4; q++) {
+				struct hdr_histogram *h = hdr_histogram_create(HDR_HISTOGRAM_DEFAULT_SCHEMA);
+				uint64_t rows = 0;
+				
+				for (unsigned int r = 0; h && r < opts->reps; r++) {
+					struct buffer_query_filter filter;
+					uint64_t t;
+					
+					buffer_filter(&filter, q, r, BUFFER_CAPACITY + atomic_load(&writer.added));
+					t = benchmark_get_time_ns();
+					storage_buffer_query(sb, &filter, count_buffer_row, &rows);
+					hdr_histogram_record(h, benchmark_get_time_ns() - t);
+				}
+				if (h)
+					print_latency(shapes[q], h, rows);
+				hdr_histogram_destroy(h);
+			}
+			
+			if (busy) {
+				atomic_store(&writer.stop, true);
+				pthread_join(thread, NULL);
+				printf("Writer:        %.0f events/sec while queried\n",
+				       atomic_load(&writer.added) / ((benchmark_get_time_ns() - start) / 1e9));
+			}
+			storage_buffer_destroy(sb);
+		}
+	}
+}
+
+static void remove_audit(const char *path)
+{
+	char other[320];
+	
+	unlink(path);
+	for (int i = 1; i <= 4; i++) {
+		snprintf(other, sizeof(other), "%s.%d", path, i);
+		unlink(other);
+	}
+}
+
+static void run_audit(const struct bench_options *opts)
+{
+	static const struct {
+		size_t batch_size;
+		bool sync;
+		size_t checkpoint;
+	} configs[] = {
+		{ 1, false, 0 },
+		{ 1, true, 0 },
+		{ 64, false, 0 },
+		{ 64, true, 0 },
+		{ 64, false, 1024 },
+		{ 512, true, 1024 },
+	};
+	char path[300];
+	
+	snprintf(path, sizeof(path), "%s/audit.log", opts->dir);
+	printf("\n=== audit_log, up to %.1f sec each ===\n", opts->seconds);
+	printf("%6s %5s %10s %12s %14s %14s %14s\n", "batch", "sync", "checkpoint", "entries",
+	       "writes/sec", "verify/sec", "range us");
+	
+	for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+		struct audit_log_config config = {
+			.log_path = path,
+			.max_file_size = (size_t)1 << 40,
+			.max_rotations = 1,
+			.sync_writes = configs[c].sync,
+			.batch_size = configs[c].batch_size,
+			.checkpoint_interval = configs[c].checkpoint,
+		};
+		struct audit_log *log;
+		struct nlmon_event evt;
+		uint64_t start, end, entries = 0, t;
+		double write_sec, verify_sec, range_us;
+		size_t error_line = 0;
+		uint64_t error_seq = 0;
+		bool valid;
+		
+		remove_audit(path);
+		log = audit_log_open(&config);
+		if (!log) {
+			fprintf(stderr, "Failed to open %s\n", path);
+			return;
+		}
+		
+		start = benchmark_get_time_ns();
+		end = start + (uint64_t)(opts->seconds * 1e9);
+		while (benchmark_get_time_ns() < end) {
+			for (int i = 0; i < 256; i++, entries++) {
+				make_event(&evt, entries);
+				audit_log_write(log, &evt, entries % 16 ? AUDIT_INFO : AUDIT_SECURITY, NULL);
+			}
+		}
+		audit_log_flush(log);
+		write_sec = (benchmark_get_time_ns() - start) / 1e9;
+		audit_log_close(log);
+		
+		t = benchmark_get_time_ns();
+		valid = audit_log_verify(path, &error_line);
+		verify_sec = (benchmark_get_time_ns() - t) / 1e9;
+		
+		/* 1000 entries from the middle, sequence numbers start at 1 */
+		t = benchmark_get_time_ns();
+		valid = audit_log_verify_range(path, entries / 2, entries / 2 + 999, &error_seq) && valid;
+		range_us = (benchmark_get_time_ns() - t) / 1e3;
+		
+		printf("%6zu %5s %10zu %12llu %14.0f %14.0f %14.1f%s\n", configs[c].batch_size,
+		       configs[c].sync ? "yes" : "no", configs[c].checkpoint,
+		       (unsigned long long)entries, entries / write_sec, entries / verify_sec,
+		       range_us, valid ? "" : "  VERIFY FAILED");
+	}
+	remove_audit(path);
+}
+
+static void run_retention(const struct bench_options *opts)
+{
+	char path[300];
+	
+	snprintf(path, sizeof(path), "%s/retention.db", opts->dir);
+	printf("\n=== storage_db retention ===\n");
+	printf("%12s %12s %10s %12s %14s %14s %10s\n", "rows", "layout", "fill sec", "MB",
+	       "delete half s", "keep 10% s", "vacuum s");
+	
+	for (size_t r = 0; r < opts->nrows; r++) {
+		size_t rows = opts->rows[r];
+		
+		for (int partitioned = 0; partitioned < 2; partitioned++) {
+			/* Sixteen partitions over the history */
+			struct storage_db *db = open_db(path, FILL_BATCH, true, false,
+			                                partitioned ? (rows + 15) / 16 : 0);
+			uint64_t t, size;
+			double fill, half, oldest, vacuum;
+			int deleted_half, deleted_oldest;
+			
+			if (!db) {
+				fprintf(stderr, "Failed to open %s\n", path);
+				return;
+			}
+			
+			t = benchmark_get_time_ns();
+			fill_db(db, 0, rows, 0);
+			storage_db_flush(db);
+			fill = (benchmark_get_time_ns() - t) / 1e9;
+			size = file_size(path);
+			
+			t = benchmark_get_time_ns();
+			deleted_half = storage_db_delete_before(db, rows / 2 + 1);
+			half = (benchmark_get_time_ns() - t) / 1e9;
+			
+			t = benchmark_get_time_ns();
+			deleted_oldest = storage_db_delete_oldest(db, rows / 10);
+			oldest = (benchmark_get_time_ns() - t) / 1e9;
+			
+			t = benchmark_get_time_ns();
+			if (partitioned)
+				storage_db_incremental_vacuum(db, 0);
+			else
+				storage_db_vacuum(db);
+			vacuum = (benchmark_get_time_ns() - t) / 1e9;
+			
+			printf("%12zu %12s %10.2f %12.1f %14.3f %14.3f %10.3f%s\n", rows,
+			       partitioned ? "16 tables" : "one table", fill, size / 1e6, half, oldest,
+			       vacuum, deleted_half < 0 || deleted_oldest < 0 ? "  DELETE FAILED" : "");
+			
+			storage_db_close(db);
+			remove_db(path);
+		}
+	}
+}
+
+static int parse_sizes(const char *spec, size_t *sizes, size_t *count)
+{
+	const char *p = spec;
+	char *end;
+	
+	for (*count = 0; *p; p = *end ? end + 1 : end) {
+		if (*count == MAX_SIZES)
+			return -1;
+		sizes[*count] = strtoull(p, &end, 10);
+		if (!sizes[*count] || (*end && *end != ','))
+			return -1;
+		(*count)++;
+	}
+	return *count ? 0 : -1;
+}
+
+static int parse_suites(const char *spec, bool *enabled)
+{
+	char *copy = strdup(spec), *saveptr = NULL, *name;
+	int ret = 0;
+	
+	if (!copy)
+		return -1;
+	for (name = strtok_r(copy, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr)) {
+		int i;
+		
+		for (i = 0; i < SUITE_COUNT && strcmp(name, suite_names[i]); i++)
+			;
+		if (i == SUITE_COUNT) {
+			ret = -1;
+			break;
+		}
+		enabled[i] = true;
+	}
+	free(copy);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_options opts = {
+		.seconds = 2,
+		.history = { 10000, 100000, 1000000 },
+		.nhistory = 3,
+		.rows = { 1000000 },
+		.nrows = 1,
+		.reps = 50,
+	};
+	bool enabled[SUITE_COUNT] = { false }, any = false;
+	const char *dir = "/tmp";
+	int opt, i;
+	
+	while ((opt = getopt(argc, argv, "s:d:H:R:r:D:")) != -1) {
+		switch (opt) {
+		case 's':
+			if (parse_suites(optarg, enabled) < 0) {
+				fprintf(stderr, "Unknown suite in %s\n", optarg);
+				return 2;
+			}
+			break;
+		case 'd':
+			opts.seconds = atof(optarg);
+			break;
+		case 'H':
+			if (parse_sizes(optarg, opts.history, &opts.nhistory) < 0)
+				goto usage;
+			break;
+		case 'R':
+			if (parse_sizes(optarg, opts.rows, &opts.nrows) < 0)
+				goto usage;
+			break;
+		case 'r':
+			opts.reps = strtoul(optarg, NULL, 10);
+			break;
+		case 'D':
+			dir = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc || opts.seconds <= 0 || !opts.reps)
+		goto usage;
+	
+	snprintf(opts.dir, sizeof(opts.dir), "%s/bench_storage.XXXXXX", dir);
+	if (!mkdtemp(opts.dir)) {
+		fprintf(stderr, "%s: %s\n", opts.dir, strerror(errno));
+		return 1;
+	}
+	
+	for (i = 0; i < SUITE_COUNT; i++)
+		any |= enabled[i];
+	if (!any)
+		memset(enabled, true, sizeof(enabled));
+	
+	printf("=== Storage benchmarks in %s ===\n", opts.dir);
+	if (enabled[SUITE_INSERT])
+		run_insert(&opts);
+	if (enabled[SUITE_QUERY])
+		run_query(&opts);
+	if (enabled[SUITE_BUFFER])
+		run_buffer(&opts);
+	if (enabled[SUITE_AUDIT])
+		run_audit(&opts);
+	if (enabled[SUITE_RETENTION])
+		run_retention(&opts);
+	
+	rmdir(opts.dir);
+	return 0;
+	
+usage:
+	fprintf(stderr, USAGE, argv[0]);
+	return 2;
+}
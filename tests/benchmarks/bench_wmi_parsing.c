@@ -0,0 +1,632 @@
+/* bench_wmi_parsing.c - WMI log parsing, conversion and lookup benchmarks
+ *
+ * Runs the bundled corpus of QCA host driver log lines through
+ * wmi_parse_log_line(), whole and by line pattern, converts the parsed
+ * entries to events with wmi_to_nlmon_event(), and times the command
+ * and vendor attribute name tables.
+ *
+ * Usage:
+ *   bench_wmi_parsing [-f corpus] [-d seconds] [-o results] [-T]
+ *
+ *   -f  Corpus, one log line per line, '#' lines skipped
+ *       (default tests/benchmarks/data/wmi_corpus.log)
+ *   -d  Length of each measurement (default 1)
+ *   -o  Append results to a file, one JSON object per measurement
+ *   -T  Exit 1 if a throughput or allocation target is missed
+ *
+ * Allocations are counted through the linker's --wrap of the allocator,
+ * see the bench_wmi_parsing rule. Branches and branch misses come from
+ * perf_event_open() and are left out where perf events are not
+ * permitted. Parse warnings of malformed lines go to /dev/null while
+ * timed, the formatting still counts.
+ */
+
+#include "benchmark_framework.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "qca_wmi.h"
+#include "qca_vendor.h"
+#include "wmi_event_bridge.h"
+
+#define USAGE "Usage: %s [-f corpus] [-d seconds] [-o results] [-T]\n"
+
+#define DEFAULT_CORPUS "tests/benchmarks/data/wmi_corpus.log"
+#define MAX_LINE 1024
+
+/* Lines parsed between checks of the clock */
+#define CHUNK 64
+
+/* Targets, per core, on the corpus as bundled */
+#define TARGET_PARSE_LINES_PER_SEC 1000000.0
+#define TARGET_PARSE_ALLOCS_PER_LINE 0.0
+#define TARGET_CONVERT_PER_SEC 500000.0
+#define TARGET_LOOKUP_NS 100.0
+
+/* Line patterns, in the order wmi_parse_log_line() tries them */
+enum wmi_pattern {
+	PATTERN_COMMAND,
+	PATTERN_LINK_LAYER_STATS,
+	PATTERN_STATS,
+	PATTERN_RCPI,
+	PATTERN_TIME_STAMP_SYNC,
+	PATTERN_MALFORMED,
+	PATTERN_COUNT
+};
+
+static const char *const pattern_names[PATTERN_COUNT] = {
+	"command", "link_layer_stats", "stats", "rcpi", "time_stamp_sync", "malformed"
+};
+
+static const char *const pattern_keywords[PATTERN_MALFORMED] = {
+	"Send WMI command:", "LINK_LAYER_STATS", "STATS REQ", "RCPI REQ",
+	"DBGLOG_TIME_STAMP_SYNC_CMDID"
+};
+
+struct corpus {
+	char **lines;
+	size_t count;
+	enum wmi_pattern *patterns;
+	size_t pattern_count[PATTERN_COUNT];
+};
+
+static double seconds = 1;
+static FILE *out;
+static int targets_missed;
+
+/* Allocator calls, counted by the --wrap wrappers below */
+
+static uint64_t allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+char *__real_strndup(const char *s, size_t n);
+
+void *__wrap_malloc(size_t size)
+{
+	allocations++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	allocations++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	allocations++;
+	return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *s)
+{
+	allocations++;
+	return __real_strdup(s);
+}
+
+char *__wrap_strndup(const char *s, size_t n)
+{
+	allocations++;
+	return __real_strndup(s, n);
+}
+
+/* Branch counters of this thread, -1 where perf events are not permitted */
+
+struct branch_counters {
+	int branches;
+	int misses;
+};
+
+static int branch_counter_open(uint64_t config, int group)
+{
+	struct perf_event_attr attr;
+	
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = group < 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static void branch_counters_open(struct branch_counters *bc)
+{
+	bc->branches = branch_counter_open(PERF_COUNT_HW_BRANCH_INSTRUCTIONS, -1);
+	bc->misses = bc->branches < 0 ? -1 :
+	             branch_counter_open(PERF_COUNT_HW_BRANCH_MISSES, bc->branches);
+	if (bc->misses < 0 && bc->branches >= 0) {
+		close(bc->branches);
+		bc->branches = -1;
+	}
+}
+
+static void branch_counters_close(struct branch_counters *bc)
+{
+	if (bc->branches < 0)
+		return;
+	close(bc->misses);
+	close(bc->branches);
+}
+
+static void branch_counters_start(struct branch_counters *bc)
+{
+	if (bc->branches < 0)
+		return;
+	ioctl(bc->branches, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(bc->branches, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/* Branches and misses since start, false without counters */
+static bool branch_counters_stop(struct branch_counters *bc, uint64_t *branches,
+                                 uint64_t *misses)
+{
+	if (bc->branches < 0)
+		return false;
+	ioctl(bc->branches, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	return read(bc->branches, branches, sizeof(*branches)) == sizeof(*branches) &&
+	       read(bc->misses, misses, sizeof(*misses)) == sizeof(*misses);
+}
+
+/* Keep the warnings of malformed lines off the terminal while timing */
+static int quiet_begin(void)
+{
+	int saved, null;
+	
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if (saved < 0 || null < 0) {
+		if (saved >= 0)
+			close(saved);
+		if (null >= 0)
+			close(null);
+		return -1;
+	}
+	dup2(null, STDOUT_FILENO);
+	close(null);
+	return saved;
+}
+
+static void quiet_end(int saved)
+{
+	if (saved < 0)
+		return;
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+}
+
+static enum wmi_pattern classify(const char *line)
+{
+	struct wmi_log_entry entry;
+	int p;
+	
+	if (wmi_parse_log_line(line, &entry) != WMI_SUCCESS)
+		return PATTERN_MALFORMED;
+	for (p = 0; p < PATTERN_MALFORMED; p++) {
+		if (strstr(line, pattern_keywords[p]))
+			return p;
+	}
+	return PATTERN_MALFORMED;
+}
+
+static int corpus_load(const char *path, struct corpus *c)
+{
+	char buf[MAX_LINE];
+	size_t capacity = 0;
+	int saved;
+	FILE *fp;
+	
+	memset(c, 0, sizeof(*c));
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	
+	while (fgets(buf, sizeof(buf), fp)) {
+		buf[strcspn(buf, "\r\n")] = '\0';
+		if (buf[0] == '#' || !buf[0])
+			continue;
+		if (c->count == capacity) {
+			char **lines;
+	
+			capacity = capacity ? capacity * 2 : 1024;
+			lines = realloc(c->lines, capacity * sizeof(*lines));
+			if (!lines)
+				break;
+			c->lines = lines;
+		}
+		c->lines[c->count] = strdup(buf);
+		if (!c->lines[c->count])
+			break;
+		c->count++;
+	}
+	fclose(fp);
+	if (!c->count) {
+		errno = ENODATA;
+		return -1;
+	}
+	
+	c->patterns = calloc(c->count, sizeof(*c->patterns));
+	if (!c->patterns)
+		return -1;
+	saved = quiet_begin();
+	for (size_t i = 0; i < c->count; i++) {
+		c->patterns[i] = classify(c->lines[i]);
+		c->pattern_count[c->patterns[i]]++;
+	}
+	quiet_end(saved);
+	return 0;
+}
+
+static void corpus_free(struct corpus *c)
+{
+	for (size_t i = 0; i < c->count; i++)
+		free(c->lines[i]);
+	free(c->lines);
+	free(c->patterns);
+}
+
+static const char *check_target(bool met)
+{
+	if (met)
+		return "ok";
+	targets_missed++;
+	return "MISS";
+}
+
+struct parse_result {
+	uint64_t lines;
+	double seconds;
+	double allocs_per_line;
+	bool have_branches;
+	double branches_per_line;
+	double misses_per_line;
+};
+
+/* Parse the lines of a pattern, all with PATTERN_COUNT, round and round */
+static void run_parse(const struct corpus *c, enum wmi_pattern pattern,
+                      struct branch_counters *bc, struct parse_result *r)
+{
+	const char **lines = calloc(c->count, sizeof(*lines));
+	struct wmi_log_entry entry;
+	uint64_t start, end, allocs, branches = 0, misses = 0;
+	size_t n = 0, next = 0;
+	int saved;
+	
+	memset(r, 0, sizeof(*r));
+	if (!lines)
+		return;
+	for (size_t i = 0; i < c->count; i++) {
+		if (pattern == PATTERN_COUNT || c->patterns[i] == pattern)
+			lines[n++] = c->lines[i];
+	}
+	if (!n) {
+		free(lines);
+		return;
+	}
+	
+	saved = quiet_begin();
+	allocs = allocations;
+	branch_counters_start(bc);
+	start = benchmark_get_time_ns();
+	end = start + (uint64_t)(seconds * 1e9);
+	do {
+		for (int i = 0; i < CHUNK; i++) {
+			wmi_parse_log_line(lines[next], &entry);
+			if (++next == n)
+				next = 0;
+		}
+		r->lines += CHUNK;
+	} while (benchmark_get_time_ns() < end);
+	r->seconds = (benchmark_get_time_ns() - start) / 1e9;
+	r->have_branches = branch_counters_stop(bc, &branches, &misses);
+	r->allocs_per_line = (double)(allocations - allocs) / r->lines;
+	quiet_end(saved);
+	
+	r->branches_per_line = (double)branches / r->lines;
+	r->misses_per_line = (double)misses / r->lines;
+	free(lines);
+}
+
+static void bench_parse(const struct corpus *c)
+{
+	struct branch_counters bc;
+	
+	branch_counters_open(&bc);
+	
+	printf("\n%-18s %6s %12s %9s %12s %10s %10s %7s\n", "parse", "share", "lines/s",
+	       "ns/line", "allocs/line", "branches", "misses", "target");
+	for (int p = PATTERN_COUNT; p >= 0; p--) {
+		const char *name = p == PATTERN_COUNT ? "corpus" : pattern_names[p];
+		size_t count = p == PATTERN_COUNT ? c->count : c->pattern_count[p];
+		const char *target = "";
+		struct parse_result r;
+		char branches[16] = "-", misses[16] = "-";
+	
+		if (!count)
+			continue;
+		run_parse(c, (enum wmi_pattern)p, &bc, &r);
+		if (!r.lines)
+			continue;
+		if (r.have_branches) {
+			snprintf(branches, sizeof(branches), "%.0f", r.branches_per_line);
+			snprintf(misses, sizeof(misses), "%.2f", r.misses_per_line);
+		}
+	
+		/* Targets hold for the corpus as a whole, the patterns show why */
+		if (p == PATTERN_COUNT)
+			target = check_target(r.lines / r.seconds >= TARGET_PARSE_LINES_PER_SEC &&
+			                      r.allocs_per_line <= TARGET_PARSE_ALLOCS_PER_LINE);
+	
+		printf("%-18s %5.1f%% %12.0f %9.1f %12.2f %10s %10s %7s\n", name,
+		       100.0 * count / c->count, r.lines / r.seconds, r.seconds * 1e9 / r.lines,
+		       r.allocs_per_line, branches, misses, target);
+		fflush(stdout);
+	
+		if (out) {
+			fprintf(out, "{\"benchmark\":\"wmi_parsing\",\"suite\":\"parse\",\"pattern\":\"%s\","
+			        "\"time\":%lld,\"lines\":%zu,\"share\":%.4f,\"lines_per_sec\":%.0f,"
+			        "\"ns_per_line\":%.1f,\"allocs_per_line\":%.3f", name, (long long)time(NULL),
+			        count, (double)count / c->count, r.lines / r.seconds,
+			        r.seconds * 1e9 / r.lines, r.allocs_per_line);
+			if (r.have_branches)
+				fprintf(out, ",\"branches_per_line\":%.1f,\"misses_per_line\":%.3f",
+				        r.branches_per_line, r.misses_per_line);
+			fprintf(out, "}\n");
+		}
+	}
+	
+	branch_counters_close(&bc);
+}
+
+static void bench_convert(const struct corpus *c)
+{
+	struct wmi_log_entry *entries = calloc(c->count, sizeof(*entries));
+	uint64_t start, end, allocs, converted = 0, failed = 0;
+	size_t n = 0, next = 0;
+	double elapsed, per_sec, allocs_per_entry;
+	int saved;
+	
+	if (!entries)
+		return;
+	saved = quiet_begin();
+	for (size_t i = 0; i < c->count; i++) {
+		if (c->patterns[i] != PATTERN_MALFORMED &&
+		    wmi_parse_log_line(c->lines[i], &entries[n]) == WMI_SUCCESS)
+			n++;
+	}
+	quiet_end(saved);
+	if (!n) {
+		free(entries);
+		return;
+	}
+	
+	allocs = allocations;
+	start = benchmark_get_time_ns();
+	end = start + (uint64_t)(seconds * 1e9);
+	do {
+		for (int i = 0; i < CHUNK; i++) {
+			struct nlmon_event event;
+	
+			memset(&event, 0, sizeof(event));
+			if (wmi_to_nlmon_event(&entries[next], &event) == 0) {
+				free(event.data);
+				free(event.user_data);
+			} else {
+				failed++;
+			}
+			if (++next == n)
+				next = 0;
+		}
+		converted += CHUNK;
+	} while (benchmark_get_time_ns() < end);
+	elapsed = (benchmark_get_time_ns() - start) / 1e9;
+	allocs_per_entry = (double)(allocations - allocs) / converted;
+	per_sec = converted / elapsed;
+	
+	printf("\n%-18s %12s %12s %13s %7s %7s\n", "convert", "entries/s", "ns/entry",
+	       "allocs/entry", "failed", "target");
+	printf("%-18s %12.0f %12.1f %13.2f %7llu %7s\n", "wmi_to_nlmon_event", per_sec,
+	       elapsed * 1e9 / converted, allocs_per_entry, (unsigned long long)failed,
+	       check_target(per_sec >= TARGET_CONVERT_PER_SEC));
+	fflush(stdout);
+	if (out)
+		fprintf(out, "{\"benchmark\":\"wmi_parsing\",\"suite\":\"convert\",\"time\":%lld,"
+		        "\"entries_per_sec\":%.0f,\"ns_per_entry\":%.1f,\"allocs_per_entry\":%.3f}\n",
+		        (long long)time(NULL), per_sec, elapsed * 1e9 / converted, allocs_per_entry);
+	free(entries);
+}
+
+/* Lookups of one kind, keys taken round and round */
+struct lookup {
+	const char *name;
+	size_t keys;
+	void (*run)(size_t key);
+};
+
+static volatile uintptr_t lookup_sink;
+
+static unsigned int known_cmds[512];
+static size_t known_cmd_count;
+static char cmd_names[512][64];
+static unsigned int known_attrs[1024];
+static size_t known_attr_count;
+static char attr_names[1024][96];
+
+static void lookup_cmd_to_string(size_t key)
+{
+	lookup_sink += (uintptr_t)wmi_cmd_to_string(known_cmds[key]);
+}
+
+/* IDs of the same ranges the table leaves out */
+static void lookup_cmd_unknown(size_t key)
+{
+	lookup_sink += (uintptr_t)wmi_cmd_to_string(known_cmds[key] + 0x80);
+}
+
+static void lookup_cmd_from_string(size_t key)
+{
+	unsigned int id = 0;
+	
+	wmi_cmd_from_string(cmd_names[key], strlen(cmd_names[key]), &id);
+	lookup_sink += id;
+}
+
+static void lookup_attr_to_string(size_t key)
+{
+	lookup_sink += (uintptr_t)qca_vendor_attr_to_string(known_attrs[key]);
+}
+
+static void lookup_attr_from_string(size_t key)
+{
+	unsigned int id = 0;
+	
+	qca_vendor_attr_from_string(attr_names[key], &id);
+	lookup_sink += id;
+}
+
+static void bench_lookup(void)
+{
+	struct lookup lookups[] = {
+		{ "wmi_cmd_to_string", 0, lookup_cmd_to_string },
+		{ "  unknown ids", 0, lookup_cmd_unknown },
+		{ "wmi_cmd_from_string", 0, lookup_cmd_from_string },
+		{ "vendor_attr_to_string", 0, lookup_attr_to_string },
+		{ "vendor_attr_from_string", 0, lookup_attr_from_string },
+	};
+	
+	/* Every name in the tables, taken from the IDs they answer to */
+	for (unsigned int id = 0x9000; id < 0x20000 && known_cmd_count < 512; id++) {
+		const char *name = wmi_cmd_to_string(id);
+		unsigned int found;
+	
+		if (wmi_cmd_from_string(name, strlen(name), &found) == 0 && found == id) {
+			known_cmds[known_cmd_count] = id;
+			snprintf(cmd_names[known_cmd_count], sizeof(cmd_names[0]), "WMI_%s_CMDID", name);
+			known_cmd_count++;
+		}
+	}
+	for (unsigned int id = 0; id < 4096 && known_attr_count < 1024; id++) {
+		const char *name = qca_vendor_attr_to_string(id);
+	
+		if (name && strcmp(name, "UNKNOWN") != 0) {
+			known_attrs[known_attr_count] = id;
+			snprintf(attr_names[known_attr_count], sizeof(attr_names[0]),
+			         "QCA_WLAN_VENDOR_ATTR_%s", name);
+			known_attr_count++;
+		}
+	}
+	lookups[0].keys = lookups[1].keys = lookups[2].keys = known_cmd_count;
+	lookups[3].keys = lookups[4].keys = known_attr_count;
+	
+	printf("\n%-24s %6s %14s %10s %7s\n", "lookup", "names", "lookups/s", "ns", "target");
+	for (size_t l = 0; l < sizeof(lookups) / sizeof(lookups[0]); l++) {
+		uint64_t start, end, count = 0;
+		size_t key = 0;
+		double ns;
+	
+		if (!lookups[l].keys)
+			continue;
+		start = benchmark_get_time_ns();
+		end = start + (uint64_t)(seconds * 1e9 / 4);
+		do {
+			for (int i = 0; i < CHUNK * 4; i++) {
+				lookups[l].run(key);
+				if (++key == lookups[l].keys)
+					key = 0;
+			}
+			count += CHUNK * 4;
+		} while (benchmark_get_time_ns() < end);
+		ns = (double)(benchmark_get_time_ns() - start) / count;
+	
+		printf("%-24s %6zu %14.0f %10.1f %7s\n", lookups[l].name, lookups[l].keys, 1e9 / ns, ns,
+		       check_target(ns <= TARGET_LOOKUP_NS));
+		fflush(stdout);
+		if (out)
+			fprintf(out, "{\"benchmark\":\"wmi_parsing\",\"suite\":\"lookup\",\"lookup\":\"%s\","
+			        "\"time\":%lld,\"names\":%zu,\"ns\":%.1f}\n", lookups[l].name[0] == ' ' ?
+			        "wmi_cmd_to_string_unknown" : lookups[l].name, (long long)time(NULL),
+			        lookups[l].keys, ns);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = DEFAULT_CORPUS;
+	const char *output = NULL;
+	bool enforce = false;
+	struct corpus corpus;
+	int opt;
+	
+	while ((opt = getopt(argc, argv, "f:d:o:T")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		case 'd':
+			seconds = atof(optarg);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'T':
+			enforce = true;
+			break;
+		default:
+			fprintf(stderr, USAGE, argv[0]);
+			return 2;
+		}
+	}
+	if (optind != argc || seconds <= 0) {
+		fprintf(stderr, USAGE, argv[0]);
+		return 2;
+	}
+	
+	if (corpus_load(path, &corpus) < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	if (output) {
+		out = fopen(output, "a");
+		if (!out) {
+			fprintf(stderr, "%s: %s\n", output, strerror(errno));
+			corpus_free(&corpus);
+			return 1;
+		}
+	}
+	
+	printf("\n");
+	printf("===============================================\n");
+	printf("  Benchmark Suite: WMI Parsing\n");
+	printf("===============================================\n");
+	printf("%s: %zu lines, %.1f sec per measurement\n", path, corpus.count, seconds);
+	
+	bench_parse(&corpus);
+	bench_convert(&corpus);
+	bench_lookup();
+	
+	printf("\n");
+	printf("===============================================\n");
+	printf("  Benchmarks Complete");
+	if (targets_missed)
+		printf(", %d targets missed", targets_missed);
+	printf("\n===============================================\n");
+	printf("\n");
+	
+	if (out)
+		fclose(out);
+	corpus_free(&corpus);
+	return enforce && targets_missed ? 1 : 0;
+}
@@ -28,7 +28,7 @@ static inline uint64_t benchmark_get_time_ns(void)
 }
 
 /* Benchmark macros */
-#define BENCHMARK(name, iterations) \
+#define BENCHMARK(name, iters) \
 	static void benchmark_##name(struct benchmark_stats *stats); \
 	static void run_benchmark_##name(void) { \
 		struct benchmark_stats stats = {0}; \
@@ -38,9 +38,9 @@ static inline uint64_t benchmark_get_time_ns(void)
 		uint64_t total_time = 0; \
 		\
 		printf("\n=== Benchmark: %s ===\n", #name); \
-		printf("Iterations: %d\n", iterations); \
+		printf("Iterations: %d\n", iters); \
 		\
-		for (int i = 0; i < iterations; i++) { \
+		for (int i = 0; i < iters; i++) { \
 			start = benchmark_get_time_ns(); \
 			benchmark_##name(&stats); \
 			end = benchmark_get_time_ns(); \
@@ -52,9 +52,9 @@ static inline uint64_t benchmark_get_time_ns(void)
 			if (duration > max_time) max_time = duration; \
 		} \
 		\
-		stats.iterations = iterations; \
+		stats.iterations = iters; \
 		stats.total_time_sec = (double)total_time / 1000000000.0; \
-		stats.avg_time_ns = (double)total_time / iterations; \
+		stats.avg_time_ns = (double)total_time / iters; \
 		stats.min_time_ns = (double)min_time; \
 		stats.max_time_ns = (double)max_time; \
 		stats.ops_per_sec = 1000000000.0 / stats.avg_time_ns; \
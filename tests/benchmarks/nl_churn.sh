@@ -0,0 +1,82 @@
+#!/bin/bash
+# nl_churn.sh - Churn interfaces, addresses, routes and neighbours
+#
+# Generates real RTM traffic for an nlmon watching the kernel, for when
+# bench_nl_traffic's injected messages are not enough. Everything happens
+# in a network namespace of its own, run nlmon in it with
+#   ip netns exec nlchurn ./nlmon ...
+#
+# Usage: nl_churn.sh [-n interfaces] [-r routes] [-d seconds] [-N netns]
+# Needs root and iproute2.
+
+set -e
+
+IFACES=16
+ROUTES=256
+SECONDS_TO_RUN=10
+NETNS=nlchurn
+
+while getopts "n:r:d:N:" opt; do
+	case $opt in
+	n) IFACES=$OPTARG ;;
+	r) ROUTES=$OPTARG ;;
+	d) SECONDS_TO_RUN=$OPTARG ;;
+	N) NETNS=$OPTARG ;;
+	*) echo "Usage: $0 [-n interfaces] [-r routes] [-d seconds] [-N netns]" >&2; exit 2 ;;
+	esac
+done
+
+if [ "$(id -u)" != 0 ]; then
+	echo "$0: needs root" >&2
+	exit 1
+fi
+
+# Interface names as bench_nl_traffic gives them
+ifname() {
+	printf "nlgen%04d" "$1"
+}
+
+cleanup() {
+	ip netns del "$NETNS" 2>/dev/null || true
+}
+trap cleanup EXIT
+
+ip netns add "$NETNS" 2>/dev/null || true
+NS="ip -n $NETNS"
+
+echo "Creating $IFACES dummy interfaces in netns $NETNS..."
+for i in $(seq 1 "$IFACES"); do
+	echo "link add $(ifname "$i") type dummy"
+	echo "link set $(ifname "$i") up"
+	echo "address add 10.$((i / 256)).$((i % 256)).1/24 dev $(ifname "$i")"
+done | $NS -batch -
+
+rounds=0
+end=$((SECONDS + SECONDS_TO_RUN))
+echo "Churning for $SECONDS_TO_RUN seconds..."
+
+# One batch per round: routes and neighbours of every interface come and
+# go, one interface flaps
+while [ $SECONDS -lt $end ]; do
+	{
+		for r in $(seq 0 $((ROUTES - 1))); do
+			i=$((r % IFACES + 1))
+			echo "route add 172.$((16 + r / 65536)).$((r / 256 % 256)).$((r % 256))/32 via 10.$((i / 256)).$((i % 256)).2 dev $(ifname "$i")"
+		done
+		for i in $(seq 1 "$IFACES"); do
+			echo "neigh add 10.$((i / 256)).$((i % 256)).2 lladdr $(printf '02:00:00:00:%02x:%02x' $((i / 256 % 256)) $((i % 256))) dev $(ifname "$i")"
+		done
+		flap=$((rounds % IFACES + 1))
+		echo "link set $(ifname "$flap") down"
+		echo "link set $(ifname "$flap") up"
+		for r in $(seq 0 $((ROUTES - 1))); do
+			echo "route del 172.$((16 + r / 65536)).$((r / 256 % 256)).$((r % 256))/32"
+		done
+		for i in $(seq 1 "$IFACES"); do
+			echo "neigh del 10.$((i / 256)).$((i % 256)).2 dev $(ifname "$i")"
+		done
+	} | $NS -force -batch - 2>/dev/null || true
+	rounds=$((rounds + 1))
+done
+
+echo "Done: $rounds rounds, about $((rounds * (2 * ROUTES + 2 * IFACES + 2))) changes"
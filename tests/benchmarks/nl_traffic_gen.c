@@ -0,0 +1,519 @@
+/* nl_traffic_gen.c - Synthetic netlink traffic for load tests */
+
+#include "nl_traffic_gen.h"
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/if_addr.h>
+#include <linux/neighbour.h>
+#include <linux/genetlink.h>
+#include <linux/nl80211.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+#include <netinet/in.h>
+
+/* A conntrack-heavy mix, like a busy router */
+static const unsigned int default_mix[NL_GEN_KIND_COUNT] = {
+	[NL_GEN_LINK] = 1,
+	[NL_GEN_ADDR] = 2,
+	[NL_GEN_ROUTE] = 8,
+	[NL_GEN_NEIGH] = 8,
+	[NL_GEN_CONNTRACK] = 40,
+	[NL_GEN_NL80211] = 2,
+};
+
+static const char *const kind_names[NL_GEN_KIND_COUNT] = {
+	[NL_GEN_LINK] = "link",
+	[NL_GEN_ADDR] = "addr",
+	[NL_GEN_ROUTE] = "route",
+	[NL_GEN_NEIGH] = "neigh",
+	[NL_GEN_CONNTRACK] = "ct",
+	[NL_GEN_NL80211] = "wifi",
+};
+
+/* Message under construction */
+struct msg_writer {
+	uint8_t *buf;
+	size_t size;
+	size_t len;
+	int full;
+};
+
+static uint64_t gen_random(struct nl_gen *gen)
+{
+	/* xorshift64* */
+	gen->state ^= gen->state >> 12;
+	gen->state ^= gen->state << 25;
+	gen->state ^= gen->state >> 27;
+	return gen->state * 0x2545F4914F6CDD1DULL;
+}
+
+/* Uniform in [0, n) */
+static uint32_t gen_pick(struct nl_gen *gen, uint32_t n)
+{
+	return (uint32_t)(((gen_random(gen) >> 32) * n) >> 32);
+}
+
+static void *msg_reserve(struct msg_writer *w, size_t len)
+{
+	size_t aligned = NLMSG_ALIGN(len);
+	void *p;
+	
+	if (w->full || w->len + aligned > w->size) {
+		w->full = 1;
+		return NULL;
+	}
+	p = w->buf + w->len;
+	memset(p, 0, aligned);
+	w->len += aligned;
+	return p;
+}
+
+static struct nlmsghdr *msg_begin(struct msg_writer *w, uint16_t type, uint16_t flags,
+                                  uint32_t seq, const void *hdr, size_t hdrlen)
+{
+	struct nlmsghdr *nlh = msg_reserve(w, NLMSG_HDRLEN);
+	void *fam;
+	
+	if (!nlh)
+		return NULL;
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = flags;
+	nlh->nlmsg_seq = seq;
+	nlh->nlmsg_pid = 0;
+	
+	fam = msg_reserve(w, hdrlen);
+	if (fam)
+		memcpy(fam, hdr, hdrlen);
+	return nlh;
+}
+
+static void put_attr(struct msg_writer *w, uint16_t type, const void *data, size_t len)
+{
+	struct nlattr *nla = msg_reserve(w, NLA_HDRLEN + len);
+	
+	if (!nla)
+		return;
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + len;
+	memcpy((uint8_t *)nla + NLA_HDRLEN, data, len);
+}
+
+static void put_u8(struct msg_writer *w, uint16_t type, uint8_t value)
+{
+	put_attr(w, type, &value, sizeof(value));
+}
+
+static void put_u16(struct msg_writer *w, uint16_t type, uint16_t value)
+{
+	put_attr(w, type, &value, sizeof(value));
+}
+
+static void put_u32(struct msg_writer *w, uint16_t type, uint32_t value)
+{
+	put_attr(w, type, &value, sizeof(value));
+}
+
+static void put_u64(struct msg_writer *w, uint16_t type, uint64_t value)
+{
+	put_attr(w, type, &value, sizeof(value));
+}
+
+static void put_str(struct msg_writer *w, uint16_t type, const char *str)
+{
+	put_attr(w, type, str, strlen(str) + 1);
+}
+
+/* Nests are flagged as the kernel flags them */
+static size_t nest_start(struct msg_writer *w, uint16_t type)
+{
+	size_t offset = w->len;
+	struct nlattr *nla = msg_reserve(w, NLA_HDRLEN);
+	
+	if (nla)
+		nla->nla_type = type | NLA_F_NESTED;
+	return offset;
+}
+
+static void nest_end(struct msg_writer *w, size_t offset)
+{
+	if (!w->full)
+		((struct nlattr *)(w->buf + offset))->nla_len = w->len - offset;
+}
+
+static void interface_name(char *name, unsigned int ifindex)
+{
+	/* Names of the dummy interfaces nl_churn.sh creates */
+	memcpy(name, "nlgen", 5);
+	name[5] = '0' + (ifindex / 1000) % 10;
+	name[6] = '0' + (ifindex / 100) % 10;
+	name[7] = '0' + (ifindex / 10) % 10;
+	name[8] = '0' + ifindex % 10;
+	name[9] = '\0';
+}
+
+static void object_mac(uint8_t *mac, uint8_t prefix, uint32_t index)
+{
+	mac[0] = 0x02;
+	mac[1] = prefix;
+	mac[2] = index >> 24;
+	mac[3] = index >> 16;
+	mac[4] = index >> 8;
+	mac[5] = index;
+}
+
+/* Address @index of the network @base, in network order */
+static uint32_t host_in(uint32_t base, uint32_t index)
+{
+	return htonl(base + index);
+}
+
+static void build_link(struct nl_gen *gen, struct msg_writer *w, int del)
+{
+	unsigned int ifindex = 1 + gen_pick(gen, gen->config.interfaces);
+	int up = gen_pick(gen, 2);
+	struct ifinfomsg ifi = {
+		.ifi_family = AF_UNSPEC,
+		.ifi_type = 1,          /* ARPHRD_ETHER, 0x10000 below is IFF_LOWER_UP */
+		.ifi_index = ifindex,
+		.ifi_flags = del ? 0 : (up ? IFF_UP | IFF_RUNNING | 0x10000 : 0) | IFF_BROADCAST,
+	};
+	char name[IFNAMSIZ];
+	uint8_t mac[6];
+	
+	interface_name(name, ifindex);
+	if (!msg_begin(w, del ? RTM_DELLINK : RTM_NEWLINK, 0, 0, &ifi, sizeof(ifi)))
+		return;
+	put_str(w, IFLA_IFNAME, name);
+	if (del)
+		return;
+	
+	object_mac(mac, 0, ifindex);
+	put_u32(w, IFLA_TXQLEN, 1000);
+	put_u8(w, IFLA_OPERSTATE, up ? 6 : 2);     /* IF_OPER_UP, IF_OPER_DOWN */
+	put_u8(w, IFLA_LINKMODE, 0);
+	put_u32(w, IFLA_MTU, 1500);
+	put_u32(w, IFLA_GROUP, 0);
+	put_u32(w, IFLA_PROMISCUITY, 0);
+	put_u32(w, IFLA_NUM_TX_QUEUES, 1);
+	put_u32(w, IFLA_NUM_RX_QUEUES, 1);
+	put_u8(w, IFLA_CARRIER, up);
+	put_str(w, IFLA_QDISC, "noqueue");
+	put_attr(w, IFLA_ADDRESS, mac, sizeof(mac));
+	put_attr(w, IFLA_BROADCAST, "\xff\xff\xff\xff\xff\xff", 6);
+}
+
+static void build_addr(struct nl_gen *gen, struct msg_writer *w, int del)
+{
+	uint32_t index = gen_pick(gen, gen->config.addresses);
+	unsigned int ifindex = 1 + index % gen->config.interfaces;
+	struct ifaddrmsg ifa = {
+		.ifa_family = AF_INET,
+		.ifa_prefixlen = 16,
+		.ifa_scope = RT_SCOPE_UNIVERSE,
+		.ifa_index = ifindex,
+	};
+	uint32_t addr = host_in(0x0a000001, index);    /* 10.0.0.1 */
+	char name[IFNAMSIZ];
+	
+	interface_name(name, ifindex);
+	if (!msg_begin(w, del ? RTM_DELADDR : RTM_NEWADDR, 0, 0, &ifa, sizeof(ifa)))
+		return;
+	put_attr(w, IFA_ADDRESS, &addr, sizeof(addr));
+	put_attr(w, IFA_LOCAL, &addr, sizeof(addr));
+	put_str(w, IFA_LABEL, name);
+	put_u32(w, IFA_FLAGS, IFA_F_PERMANENT);
+}
+
+static void build_route(struct nl_gen *gen, struct msg_writer *w, int del)
+{
+	uint32_t index = gen_pick(gen, gen->config.routes);
+	unsigned int ifindex = 1 + index % gen->config.interfaces;
+	struct rtmsg rtm = {
+		.rtm_family = AF_INET,
+		.rtm_dst_len = 24,
+		.rtm_table = RT_TABLE_MAIN,
+		.rtm_protocol = RTPROT_STATIC,
+		.rtm_scope = RT_SCOPE_UNIVERSE,
+		.rtm_type = RTN_UNICAST,
+	};
+	uint32_t dst = host_in(0xac100000, index << 8);   /* 172.16.0.0/12 in /24s */
+	uint32_t gw = host_in(0x0a000001, ifindex - 1);
+	
+	if (!msg_begin(w, del ? RTM_DELROUTE : RTM_NEWROUTE, 0, 0, &rtm, sizeof(rtm)))
+		return;
+	put_u32(w, RTA_TABLE, RT_TABLE_MAIN);
+	put_attr(w, RTA_DST, &dst, sizeof(dst));
+	put_attr(w, RTA_GATEWAY, &gw, sizeof(gw));
+	put_u32(w, RTA_OIF, ifindex);
+	put_u32(w, RTA_PRIORITY, 100 + index % 8);
+}
+
+static void build_neigh(struct nl_gen *gen, struct msg_writer *w, int del)
+{
+	uint32_t index = gen_pick(gen, gen->config.neighbours);
+	struct ndmsg ndm = {
+		.ndm_family = AF_INET,
+		.ndm_ifindex = 1 + index % gen->config.interfaces,
+		.ndm_state = del ? NUD_FAILED : (gen_pick(gen, 4) ? NUD_REACHABLE : NUD_STALE),
+		.ndm_type = RTN_UNICAST,
+	};
+	uint32_t dst = host_in(0xc0a80001, index);     /* 192.168.0.1 */
+	uint8_t mac[6];
+	
+	object_mac(mac, 1, index);
+	if (!msg_begin(w, del ? RTM_DELNEIGH : RTM_NEWNEIGH, 0, 0, &ndm, sizeof(ndm)))
+		return;
+	put_attr(w, NDA_DST, &dst, sizeof(dst));
+	if (!del)
+		put_attr(w, NDA_LLADDR, mac, sizeof(mac));
+	put_u32(w, NDA_PROBES, 0);
+}
+
+static void put_tuple(struct msg_writer *w, uint16_t type, uint32_t src, uint32_t dst,
+                      uint8_t proto, uint16_t sport, uint16_t dport)
+{
+	size_t tuple = nest_start(w, type);
+	size_t nest;
+	
+	nest = nest_start(w, CTA_TUPLE_IP);
+	put_attr(w, CTA_IP_V4_SRC, &src, sizeof(src));
+	put_attr(w, CTA_IP_V4_DST, &dst, sizeof(dst));
+	nest_end(w, nest);
+	
+	nest = nest_start(w, CTA_TUPLE_PROTO);
+	put_u8(w, CTA_PROTO_NUM, proto);
+	put_u16(w, CTA_PROTO_SRC_PORT, htons(sport));
+	put_u16(w, CTA_PROTO_DST_PORT, htons(dport));
+	nest_end(w, nest);
+	
+	nest_end(w, tuple);
+}
+
+static void build_conntrack(struct nl_gen *gen, struct msg_writer *w, int del)
+{
+	static const uint16_t services[] = { 443, 443, 443, 80, 53, 123 };
+	uint32_t index = gen_pick(gen, gen->config.flows);
+	uint16_t dport = services[index % (sizeof(services) / sizeof(services[0]))];
+	uint8_t proto = dport == 53 || dport == 123 ? IPPROTO_UDP : IPPROTO_TCP;
+	uint32_t src = host_in(0x0a800000, index >> 8);        /* 10.128.0.0/9 */
+	uint32_t dst = host_in(0xcb007101, index % 16);        /* 203.0.113.1 */
+	uint16_t sport = 32768 + (index & 0xff) * 64 + (index >> 20);
+	struct nfgenmsg nfg = { .nfgen_family = AF_INET, .version = NFNETLINK_V0 };
+	int created = !del && gen_pick(gen, 3) == 0;
+	uint16_t type = (NFNL_SUBSYS_CTNETLINK << 8) | (del ? IPCTNL_MSG_CT_DELETE : IPCTNL_MSG_CT_NEW);
+	size_t nest, info;
+	
+	if (!msg_begin(w, type, created ? NLM_F_CREATE | NLM_F_EXCL : 0, 0, &nfg, sizeof(nfg)))
+		return;
+	
+	put_tuple(w, CTA_TUPLE_ORIG, src, dst, proto, sport, dport);
+	put_tuple(w, CTA_TUPLE_REPLY, dst, src, proto, dport, sport);
+	put_u32(w, CTA_STATUS, htonl(created ? 0x8 : 0x18e));
+	if (!del)
+		put_u32(w, CTA_TIMEOUT, htonl(proto == IPPROTO_TCP ? 432000 : 30));
+	put_u32(w, CTA_MARK, htonl(0));
+	
+	if (proto == IPPROTO_TCP) {
+		nest = nest_start(w, CTA_PROTOINFO);
+		info = nest_start(w, CTA_PROTOINFO_TCP);
+		put_u8(w, CTA_PROTOINFO_TCP_STATE, del ? 7 : created ? 1 : 3);
+		nest_end(w, info);
+		nest_end(w, nest);
+	}
+	
+	/* Accounting comes with the last event of a flow */
+	if (del) {
+		nest = nest_start(w, CTA_COUNTERS_ORIG);
+		put_u64(w, CTA_COUNTERS_PACKETS, htobe64(1 + index % 1000));
+		put_u64(w, CTA_COUNTERS_BYTES, htobe64(64 + index % 100000));
+		nest_end(w, nest);
+		nest = nest_start(w, CTA_COUNTERS_REPLY);
+		put_u64(w, CTA_COUNTERS_PACKETS, htobe64(1 + index % 800));
+		put_u64(w, CTA_COUNTERS_BYTES, htobe64(64 + index % 900000));
+		nest_end(w, nest);
+	}
+	put_u32(w, CTA_ID, htonl(index));
+}
+
+static void build_nl80211(struct nl_gen *gen, struct msg_writer *w, int del)
+{
+	uint32_t index = gen_pick(gen, gen->config.neighbours);
+	struct genlmsghdr genl = {
+		.cmd = del ? NL80211_CMD_DEL_STATION : NL80211_CMD_NEW_STATION,
+		.version = 1,
+	};
+	uint8_t mac[6];
+	
+	object_mac(mac, 2, index);
+	if (!msg_begin(w, NL_GEN_NL80211_FAMILY, 0, 0, &genl, sizeof(genl)))
+		return;
+	put_u32(w, NL80211_ATTR_WIPHY, index % 2);
+	put_u32(w, NL80211_ATTR_IFINDEX, 1 + index % gen->config.interfaces);
+	put_attr(w, NL80211_ATTR_MAC, mac, sizeof(mac));
+	put_u32(w, NL80211_ATTR_GENERATION, gen->seq);
+	if (!del)
+		put_u32(w, NL80211_ATTR_WIPHY_FREQ, index % 2 ? 5180 : 2437);
+}
+
+int nl_gen_init(struct nl_gen *gen, const struct nl_gen_config *config)
+{
+	const unsigned int *mix;
+	unsigned int total = 0;
+	int i;
+	
+	memset(gen, 0, sizeof(*gen));
+	if (config)
+		gen->config = *config;
+	
+	for (i = 0; i < NL_GEN_KIND_COUNT; i++)
+		total += gen->config.mix[i];
+	mix = total ? gen->config.mix : default_mix;
+	
+	total = 0;
+	for (i = 0; i < NL_GEN_KIND_COUNT; i++) {
+		total += mix[i];
+		gen->cumulative[i] = total;
+	}
+	if (!total)
+		return -1;
+	gen->total_weight = total;
+	
+	if (!gen->config.interfaces)
+		gen->config.interfaces = 16;
+	if (!gen->config.addresses)
+		gen->config.addresses = 256;
+	if (!gen->config.routes)
+		gen->config.routes = 1024;
+	if (!gen->config.neighbours)
+		gen->config.neighbours = 1024;
+	if (!gen->config.flows)
+		gen->config.flows = 65536;
+	if (!gen->config.delete_percent)
+		gen->config.delete_percent = 25;
+	
+	/* The interface names have four digits */
+	if (gen->config.interfaces > 9999)
+		gen->config.interfaces = 9999;
+	
+	gen->state = gen->config.seed ? gen->config.seed : 0x9E3779B97F4A7C15ULL;
+	return 0;
+}
+
+int nl_gen_parse_mix(struct nl_gen_config *config, const char *spec)
+{
+	unsigned int mix[NL_GEN_KIND_COUNT] = { 0 };
+	const char *p = spec;
+	
+	while (*p) {
+		const char *eq = strchr(p, '=');
+		char *end;
+		unsigned long weight;
+		int i;
+		
+		if (!eq)
+			return -1;
+		for (i = 0; i < NL_GEN_KIND_COUNT; i++) {
+			if (strlen(kind_names[i]) == (size_t)(eq - p) &&
+			    strncmp(p, kind_names[i], eq - p) == 0)
+				break;
+		}
+		if (i == NL_GEN_KIND_COUNT)
+			return -1;
+		
+		weight = strtoul(eq + 1, &end, 10);
+		if (end == eq + 1 || (*end && *end != ',') || weight > 1000000)
+			return -1;
+		mix[i] = weight;
+		
+		p = *end ? end + 1 : end;
+	}
+	
+	memcpy(config->mix, mix, sizeof(mix));
+	return 0;
+}
+
+int nl_gen_protocol(enum nl_gen_kind kind)
+{
+	switch (kind) {
+	case NL_GEN_CONNTRACK:
+		return NETLINK_NETFILTER;
+	case NL_GEN_NL80211:
+		return NETLINK_GENERIC;
+	default:
+		return NETLINK_ROUTE;
+	}
+}
+
+const char *nl_gen_kind_name(enum nl_gen_kind kind)
+{
+	return kind < NL_GEN_KIND_COUNT ? kind_names[kind] : "unknown";
+}
+
+size_t nl_gen_next(struct nl_gen *gen, void *buf, size_t size, enum nl_gen_kind *kind)
+{
+	struct msg_writer w = { .buf = buf, .size = size };
+	uint32_t r = gen_pick(gen, gen->total_weight);
+	int del = gen_pick(gen, 100) < gen->config.delete_percent;
+	struct nlmsghdr *nlh;
+	int k = 0;
+	
+	while (r >= gen->cumulative[k])
+		k++;
+	
+	switch (k) {
+	case NL_GEN_LINK:
+		build_link(gen, &w, del);
+		break;
+	case NL_GEN_ADDR:
+		build_addr(gen, &w, del);
+		break;
+	case NL_GEN_ROUTE:
+		build_route(gen, &w, del);
+		break;
+	case NL_GEN_NEIGH:
+		build_neigh(gen, &w, del);
+		break;
+	case NL_GEN_CONNTRACK:
+		build_conntrack(gen, &w, del);
+		break;
+	default:
+		build_nl80211(gen, &w, del);
+		break;
+	}
+	
+	if (w.full)
+		return 0;
+	
+	nlh = buf;
+	nlh->nlmsg_len = w.len;
+	nlh->nlmsg_seq = ++gen->seq;
+	gen->generated[k]++;
+	if (kind)
+		*kind = k;
+	return w.len;
+}
+
+size_t nl_gen_fill(struct nl_gen *gen, void *buf, size_t size, size_t max,
+                   enum nl_gen_kind *kinds, size_t *count)
+{
+	uint8_t *p = buf;
+	size_t used = 0, n = 0, len;
+	
+	/* Stop short rather than leave a message cut off */
+	while (n < max && size - used >= NL_GEN_MAX_MSG) {
+		len = nl_gen_next(gen, p + used, size - used, kinds ? &kinds[n] : NULL);
+		if (!len)
+			break;
+		used += len;
+		n++;
+	}
+	
+	if (count)
+		*count = n;
+	return used;
+}
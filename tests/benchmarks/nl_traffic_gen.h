@@ -0,0 +1,124 @@
+/* nl_traffic_gen.h - Synthetic netlink traffic for load tests
+ *
+ * Builds the messages the kernel sends a monitor: RTM link, address,
+ * route and neighbour notifications, conntrack events and nl80211
+ * station and connection events. Messages are written back to back into
+ * a caller's buffer, as one recvmsg() would return them, without going
+ * through libnl, so generating is far cheaper than what it feeds.
+ *
+ * The mix says how often each kind of message is picked, the
+ * cardinality how many distinct interfaces, addresses, routes,
+ * neighbours and flows the objects are drawn from. Sequences are
+ * repeatable for one seed.
+ */
+
+#ifndef NL_TRAFFIC_GEN_H
+#define NL_TRAFFIC_GEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kinds of generated messages */
+enum nl_gen_kind {
+	NL_GEN_LINK,
+	NL_GEN_ADDR,
+	NL_GEN_ROUTE,
+	NL_GEN_NEIGH,
+	NL_GEN_CONNTRACK,
+	NL_GEN_NL80211,
+	NL_GEN_KIND_COUNT
+};
+
+/* Message type of nl80211 messages, a family id the kernel could assign */
+#define NL_GEN_NL80211_FAMILY 0x1c
+
+/* Longest generated message */
+#define NL_GEN_MAX_MSG 512
+
+/* Generator configuration, zero fields take the defaults */
+struct nl_gen_config {
+	unsigned int mix[NL_GEN_KIND_COUNT]; /* Relative weight of each kind (all 0 = default mix) */
+	unsigned int interfaces;        /* Distinct interfaces (0=16) */
+	unsigned int addresses;         /* Distinct addresses (0=256) */
+	unsigned int routes;            /* Distinct routes (0=1024) */
+	unsigned int neighbours;        /* Distinct neighbours (0=1024) */
+	unsigned int flows;             /* Distinct conntrack flows (0=65536) */
+	unsigned int delete_percent;    /* Share of messages deleting an object (0=25) */
+	uint64_t seed;                  /* Random seed (0=fixed default) */
+};
+
+/* Generator state */
+struct nl_gen {
+	struct nl_gen_config config;
+	unsigned int cumulative[NL_GEN_KIND_COUNT];
+	unsigned int total_weight;
+	uint64_t state;
+	uint32_t seq;
+	uint64_t generated[NL_GEN_KIND_COUNT];
+};
+
+/**
+ * nl_gen_init() - Initialize a generator
+ * @gen: Generator
+ * @config: Configuration, NULL for the defaults
+ *
+ * Returns: 0 on success, -1 if every weight of a given mix is 0
+ */
+int nl_gen_init(struct nl_gen *gen, const struct nl_gen_config *config);
+
+/**
+ * nl_gen_parse_mix() - Parse a message mix
+ * @config: Configuration to set the mix of
+ * @spec: Comma separated kind=weight pairs, e.g. "route=4,ct=10";
+ *        kinds are link, addr, route, neigh, ct and wifi
+ *
+ * Kinds not named get weight 0.
+ *
+ * Returns: 0 on success, -1 on a malformed spec
+ */
+int nl_gen_parse_mix(struct nl_gen_config *config, const char *spec);
+
+/**
+ * nl_gen_protocol() - Netlink protocol of a kind
+ * @kind: Message kind
+ *
+ * Returns: NETLINK_ROUTE, NETLINK_NETFILTER or NETLINK_GENERIC
+ */
+int nl_gen_protocol(enum nl_gen_kind kind);
+
+/**
+ * nl_gen_kind_name() - Name of a kind, as used by nl_gen_parse_mix()
+ * @kind: Message kind
+ */
+const char *nl_gen_kind_name(enum nl_gen_kind kind);
+
+/**
+ * nl_gen_next() - Generate one message
+ * @gen: Generator
+ * @buf: Output, NLMSG_ALIGNTO aligned
+ * @size: Size of @buf
+ * @kind: Output for the kind of the message (can be NULL)
+ *
+ * Returns: Aligned length of the message, 0 if it did not fit
+ */
+size_t nl_gen_next(struct nl_gen *gen, void *buf, size_t size, enum nl_gen_kind *kind);
+
+/**
+ * nl_gen_fill() - Generate messages back to back
+ * @gen: Generator
+ * @buf: Output, NLMSG_ALIGNTO aligned
+ * @size: Size of @buf
+ * @max: Most messages to generate
+ * @kinds: Output for the kind of each message, @max entries (can be NULL)
+ * @count: Output for the number of messages
+ *
+ * Walk the result with NLMSG_OK()/NLMSG_NEXT() like a receive buffer.
+ * Message types of different protocols overlap, the nl80211 family id
+ * with RTM_NEWNEIGH for one, so a buffer mixing them needs @kinds.
+ *
+ * Returns: Bytes used
+ */
+size_t nl_gen_fill(struct nl_gen *gen, void *buf, size_t size, size_t max,
+                   enum nl_gen_kind *kinds, size_t *count);
+
+#endif /* NL_TRAFFIC_GEN_H */
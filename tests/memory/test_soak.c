@@ -0,0 +1,530 @@
+/* test_soak.c - Long-running soak test with memory and latency drift detection
+ *
+ * Drives the full pipeline - parsing, the event processor with its event
+ * pool, the filter and the in-memory event history - with the netlink
+ * load generator at a steady rate for hours, and samples the process
+ * every interval: resident memory, heap in use and its fragmentation,
+ * event pool use and queue depth, and the end-to-end latency percentiles
+ * of the interval.
+ *
+ * Once the warmup is over, the run fails as soon as
+ *  - RSS or the heap in use keeps growing: the lowest sample of the
+ *    latest quarter of the run is above the highest of its first quarter
+ *    by more than the growth threshold, or
+ *  - latency drifts: the median p99 of the latest quarter exceeds the
+ *    median p99 of the first quarter by more than the drift threshold.
+ * Comparing quarters rather than neighbouring samples keeps steady-state
+ * noise, like the history filling up or a slow interval, from failing it.
+ *
+ * Usage:
+ *   test_soak [-d duration] [-i interval] [-w warmup] [-r rate] [-f filter]
+ *             [-H history] [-g growth%] [-l drift%] [-o samples.csv]
+ *
+ *   -d  Length of the run, in seconds or with an s, m or h suffix (default 4h)
+ *   -i  Sampling interval (default 60s)
+ *   -w  Warmup not held against the run (default 5m)
+ *   -r  Messages per second (default 10000)
+ *   -f  Filter expression the events are evaluated against
+ *   -H  Events kept in the history buffer (default 10000)
+ *   -g  Memory growth allowed, in percent of the first quarter (default 10)
+ *   -l  p99 latency drift allowed, in percent (default 50)
+ *   -o  Append every sample to a CSV file
+ *
+ * Exits 0 if the run held steady, 1 on growth or drift, 2 on bad usage.
+ * SIGINT or SIGTERM ends the run early with the checks done so far.
+ */
+
+#include <errno.h>
+#include <malloc.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/netlink.h>
+
+#include "nl_traffic_gen.h"
+#include "event_processor.h"
+#include "event_trace.h"
+#include "hdr_histogram.h"
+#include "nlmon_nl_event.h"
+#include "resource_tracker.h"
+#include "storage_buffer.h"
+#include "filter_parser.h"
+#include "filter_compiler.h"
+#include "filter_eval.h"
+
+#define USAGE "Usage: %s [-d duration] [-i interval] [-w warmup] [-r rate] [-f filter]\n" \
+              "       [-H history] [-g growth%%] [-l drift%%] [-o samples.csv]\n"
+
+#define BURST 32
+
+/* Quarters need this many samples before they are compared */
+#define MIN_CHECK_SAMPLES 8
+
+/* Growth below this many bytes is noise whatever the percentage */
+#define MIN_GROWTH_BYTES (4UL << 20)
+
+struct soak_pipeline {
+	struct filter_bytecode *filter;
+	struct storage_buffer *history;
+	struct hdr_histogram *latency;
+	_Atomic uint64_t handled;
+};
+
+struct soak_sample {
+	double elapsed;
+	uint64_t rss;
+	uint64_t heap_used;
+	uint64_t heap_free;
+	double fragmentation;
+	size_t pool_usage;
+	size_t queue_size;
+	unsigned long dropped;
+	uint64_t handled;
+	double p50;
+	double p99;
+	double max;
+};
+
+struct soak_samples {
+	struct soak_sample *v;
+	size_t count;
+	size_t capacity;
+};
+
+static volatile sig_atomic_t g_running = 1;
+static struct soak_pipeline g_pipeline;
+
+static void signal_handler(int sig)
+{
+	(void)sig;
+	g_running = 0;
+}
+
+/* End-to-end latency, from receipt until the handlers are done */
+static void trace_sink(const struct nlmon_event_trace *trace, enum nlmon_trace_stage stage,
+                       void *ctx)
+{
+	struct soak_pipeline *pipeline = ctx;
+	
+	if ((stage == NLMON_TRACE_STAGES || stage == NLMON_TRACE_HANDLER) &&
+	    trace->offset_ns[NLMON_TRACE_HANDLER])
+		hdr_histogram_record(pipeline->latency, trace->offset_ns[NLMON_TRACE_HANDLER]);
+}
+
+static void soak_handler(struct nlmon_event *event, void *ctx)
+{
+	struct soak_pipeline *pipeline = ctx;
+	
+	atomic_fetch_add_explicit(&pipeline->handled, 1, memory_order_relaxed);
+	if (pipeline->filter && !filter_eval(pipeline->filter, event, NULL))
+		return;
+	nlmon_trace_stamp(&event->trace, NLMON_TRACE_FILTER);
+	storage_buffer_add(pipeline->history, event);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline_ns)
+{
+	uint64_t now = now_ns();
+	struct timespec ts;
+	
+	if (now >= deadline_ns)
+		return;
+	ts.tv_sec = (deadline_ns - now) / 1000000000ULL;
+	ts.tv_nsec = (deadline_ns - now) % 1000000000ULL;
+	nanosleep(&ts, NULL);
+}
+
+/* Seconds, or a number with an s, m or h suffix */
+static double parse_duration(const char *s)
+{
+	char *end;
+	double value = strtod(s, &end);
+	
+	if (end == s || value < 0)
+		return -1;
+	if (!*end || !strcmp(end, "s"))
+		return value;
+	if (!strcmp(end, "m"))
+		return value * 60;
+	if (!strcmp(end, "h"))
+		return value * 3600;
+	return -1;
+}
+
+/* Parse one generated buffer and submit its events */
+static void submit_buffer(struct event_processor *ep, void *buf, size_t len,
+                          const enum nl_gen_kind *kinds, size_t count, uint64_t *errors)
+{
+	struct nlmon_event events[BURST];
+	struct nlmsghdr *nlh = buf;
+	uint64_t recv_ns = nlmon_trace_now();
+	int remaining = len;
+	size_t i, n = 0;
+	
+	for (i = 0; i < count && NLMSG_OK(nlh, remaining); i++, nlh = NLMSG_NEXT(nlh, remaining)) {
+		struct nlmon_event *evt = &events[n];
+		
+		if (nlmon_nl_parse_message(nlh, evt, nl_gen_protocol(kinds[i])) < 0) {
+			free(evt->netlink.data.generic);
+			(*errors)++;
+			continue;
+		}
+		
+		nlmon_trace_begin(&evt->trace, recv_ns);
+		nlmon_trace_stamp(&evt->trace, NLMON_TRACE_PARSE);
+		
+		/* Queued copies take the payload along, as from a receive thread */
+		evt->data_size = nlmon_nl_event_payload_size(evt);
+		evt->data = evt->data_size ? evt->netlink.data.generic : NULL;
+		evt->raw_msg = NULL;
+		evt->raw_msg_len = 0;
+		n++;
+	}
+	
+	event_processor_submit_batch(ep, 0, events, n);
+	for (i = 0; i < n; i++)
+		free(events[i].netlink.data.generic);
+}
+
+static int take_sample(struct soak_samples *samples, struct event_processor *ep,
+                       struct resource_tracker *tracker, double elapsed)
+{
+	struct resource_stats stats;
+	struct soak_sample *s;
+	struct mallinfo2 mi = mallinfo2();
+	unsigned long submitted, processed, dropped, rate_limited;
+	
+	if (samples->count == samples->capacity) {
+		size_t capacity = samples->capacity ? samples->capacity * 2 : 256;
+		struct soak_sample *v = realloc(samples->v, capacity * sizeof(*v));
+		
+		if (!v)
+			return -1;
+		samples->v = v;
+		samples->capacity = capacity;
+	}
+	s = &samples->v[samples->count++];
+	memset(s, 0, sizeof(*s));
+	s->elapsed = elapsed;
+	
+	resource_tracker_update_system_metrics(tracker);
+	if (resource_tracker_get_stats(tracker, &stats))
+		s->rss = stats.memory_rss_bytes;
+	
+	/* The totals malloc_info() reports, over every arena */
+	s->heap_used = mi.uordblks + mi.hblkhd;
+	s->heap_free = mi.fordblks;
+	s->fragmentation = mi.arena ? 100.0 * mi.fordblks / mi.arena : 0;
+	
+	event_processor_stats(ep, &submitted, &processed, &dropped, &rate_limited,
+	                      &s->queue_size, &s->pool_usage);
+	s->dropped = dropped;
+	s->handled = atomic_load(&g_pipeline.handled);
+	
+	s->p50 = hdr_histogram_quantile(g_pipeline.latency, 0.5);
+	s->p99 = hdr_histogram_quantile(g_pipeline.latency, 0.99);
+	s->max = hdr_histogram_max(g_pipeline.latency);
+	hdr_histogram_reset(g_pipeline.latency);
+	return 0;
+}
+
+static void print_sample(const struct soak_sample *s, FILE *csv)
+{
+	printf("%8.0f %10.1f %10.1f %8.1f %8zu %8zu %10lu %10.1f %10.1f %10.1f\n",
+	       s->elapsed, s->rss / 1048576.0, s->heap_used / 1048576.0, s->fragmentation,
+	       s->pool_usage, s->queue_size, s->dropped, s->p50 / 1e3, s->p99 / 1e3,
+	       s->max / 1e3);
+	fflush(stdout);
+	
+	if (csv) {
+		fprintf(csv, "%.0f,%llu,%llu,%llu,%.2f,%zu,%zu,%lu,%llu,%.0f,%.0f,%.0f\n",
+		        s->elapsed, (unsigned long long)s->rss, (unsigned long long)s->heap_used,
+		        (unsigned long long)s->heap_free, s->fragmentation, s->pool_usage,
+		        s->queue_size, s->dropped, (unsigned long long)s->handled, s->p50, s->p99,
+		        s->max);
+		fflush(csv);
+	}
+}
+
+static uint64_t sample_rss(const struct soak_sample *s)
+{
+	return s->rss;
+}
+
+static uint64_t sample_heap(const struct soak_sample *s)
+{
+	return s->heap_used;
+}
+
+/* Lowest of the last quarter above the highest of the first by more than @growth% */
+static bool memory_grew(const struct soak_sample *v, size_t n, uint64_t (*get)(const struct soak_sample *),
+                        double growth, uint64_t *from, uint64_t *to)
+{
+	size_t quarter = n / 4, i;
+	uint64_t first_max = 0, last_min = UINT64_MAX;
+	
+	for (i = 0; i < quarter; i++) {
+		if (get(&v[i]) > first_max)
+			first_max = get(&v[i]);
+		if (get(&v[n - 1 - i]) < last_min)
+			last_min = get(&v[n - 1 - i]);
+	}
+	*from = first_max;
+	*to = last_min;
+	
+	if (last_min <= first_max || last_min - first_max < MIN_GROWTH_BYTES)
+		return false;
+	return last_min - first_max > first_max * growth / 100;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	
+	return (x > y) - (x < y);
+}
+
+static double median_p99(const struct soak_sample *v, size_t n)
+{
+	double p99[n];
+	size_t i, count = 0;
+	
+	for (i = 0; i < n; i++) {
+		/* Intervals without traffic have no latency */
+		if (v[i].p99 > 0)
+			p99[count++] = v[i].p99;
+	}
+	if (!count)
+		return 0;
+	qsort(p99, count, sizeof(p99[0]), compare_double);
+	return p99[count / 2];
+}
+
+/* Check the samples after the warmup, returns the number of failures */
+static int check_drift(const struct soak_samples *samples, size_t first, double growth,
+                       double drift, bool verbose)
+{
+	const struct soak_sample *v = samples->v + first;
+	size_t n = samples->count - first, quarter = n / 4;
+	uint64_t from, to;
+	double base, latest;
+	int failures = 0;
+	
+	if (n < MIN_CHECK_SAMPLES)
+		return 0;
+	
+	if (memory_grew(v, n, sample_rss, growth, &from, &to)) {
+		printf("FAIL: RSS grew from %.1f MB to %.1f MB\n", from / 1048576.0, to / 1048576.0);
+		failures++;
+	} else if (verbose) {
+		printf("RSS:      steady (%.1f MB, then %.1f MB at least)\n", from / 1048576.0,
+		       to / 1048576.0);
+	}
+	
+	if (memory_grew(v, n, sample_heap, growth, &from, &to)) {
+		printf("FAIL: Heap in use grew from %.1f MB to %.1f MB\n", from / 1048576.0,
+		       to / 1048576.0);
+		failures++;
+	} else if (verbose) {
+		printf("Heap:     steady (%.1f MB, then %.1f MB at least)\n", from / 1048576.0,
+		       to / 1048576.0);
+	}
+	
+	base = median_p99(v, quarter);
+	latest = median_p99(v + n - quarter, quarter);
+	if (base > 0 && latest > base * (1 + drift / 100)) {
+		printf("FAIL: p99 latency drifted from %.1f us to %.1f us\n", base / 1e3, latest / 1e3);
+		failures++;
+	} else if (verbose) {
+		printf("Latency:  steady (p99 %.1f us, then %.1f us)\n", base / 1e3, latest / 1e3);
+	}
+	return failures;
+}
+
+int main(int argc, char **argv)
+{
+	static uint8_t buf[BURST * NL_GEN_MAX_MSG] __attribute__((aligned(NLMSG_ALIGNTO)));
+	enum nl_gen_kind kinds[BURST];
+	struct event_processor_config ep_config = {
+		.ring_buffer_size = 65536,
+		.thread_pool_size = 2,
+		.work_queue_size = 4096,
+		.enable_object_pool = true,
+		.object_pool_size = 65536,
+	};
+	struct nl_gen_config gen_config = { 0 };
+	struct soak_samples samples = { 0 };
+	struct event_processor *ep;
+	struct resource_tracker *tracker;
+	struct filter_expr *expr = NULL;
+	struct nl_gen gen;
+	const char *filter = NULL, *csv_path = NULL;
+	double duration = 4 * 3600, interval = 60, warmup = 300, rate = 10000;
+	double growth = 10, drift = 50;
+	unsigned long history = 10000;
+	uint64_t start, end, next_sample, messages = 0, errors = 0;
+	size_t first_checked = 0;
+	FILE *csv = NULL;
+	int opt, failures = 0;
+	
+	while ((opt = getopt(argc, argv, "d:i:w:r:f:H:g:l:o:")) != -1) {
+		switch (opt) {
+		case 'd':
+			duration = parse_duration(optarg);
+			break;
+		case 'i':
+			interval = parse_duration(optarg);
+			break;
+		case 'w':
+			warmup = parse_duration(optarg);
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case 'H':
+			history = strtoul(optarg, NULL, 10);
+			break;
+		case 'g':
+			growth = atof(optarg);
+			break;
+		case 'l':
+			drift = atof(optarg);
+			break;
+		case 'o':
+			csv_path = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	
+	if (optind != argc || duration <= 0 || interval <= 0 || warmup < 0 || rate <= 0 ||
+	    !history || growth <= 0 || drift <= 0)
+		goto usage;
+	
+	if (nl_gen_init(&gen, &gen_config) < 0) {
+		fprintf(stderr, "Failed to initialize the traffic generator\n");
+		return 1;
+	}
+	
+	if (filter) {
+		expr = filter_parse(filter);
+		g_pipeline.filter = expr ? filter_compile(expr) : NULL;
+		if (!g_pipeline.filter) {
+			fprintf(stderr, "Invalid filter: %s\n", filter);
+			return 2;
+		}
+	}
+	
+	if (csv_path) {
+		csv = fopen(csv_path, "a");
+		if (!csv) {
+			fprintf(stderr, "%s: %s\n", csv_path, strerror(errno));
+			return 1;
+		}
+		fprintf(csv, "elapsed,rss,heap_used,heap_free,fragmentation,pool_usage,queue_size,"
+		        "dropped,handled,p50_ns,p99_ns,max_ns\n");
+	}
+	
+	g_pipeline.history = storage_buffer_create(history);
+	g_pipeline.latency = hdr_histogram_create(HDR_HISTOGRAM_DEFAULT_SCHEMA);
+	tracker = resource_tracker_create(0);
+	ep = event_processor_create(&ep_config);
+	if (!g_pipeline.history || !g_pipeline.latency || !tracker || !ep ||
+	    event_processor_register_handler(ep, soak_handler, &g_pipeline) < 0) {
+		fprintf(stderr, "Failed to set up the pipeline\n");
+		return 1;
+	}
+	nlmon_trace_set_sink(trace_sink, &g_pipeline, 0);
+	
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+	
+	printf("=== Soak test: %.0f s at %.0f msgs/sec, sampled every %.0f s ===\n",
+	       duration, rate, interval);
+	printf("Warmup %.0f s, failing on %.0f%% memory growth or %.0f%% p99 drift\n\n",
+	       warmup, growth, drift);
+	printf("%8s %10s %10s %8s %8s %8s %10s %10s %10s %10s\n", "elapsed", "rss MB",
+	       "heap MB", "frag %", "pool", "queue", "dropped", "p50 us", "p99 us", "max us");
+	
+	start = now_ns();
+	end = start + (uint64_t)(duration * 1e9);
+	next_sample = start + (uint64_t)(interval * 1e9);
+	
+	while (g_running && !failures) {
+		uint64_t now = now_ns();
+		size_t count, len;
+		
+		if (now >= next_sample || now >= end) {
+			double elapsed = (now - start) / 1e9;
+			
+			if (take_sample(&samples, ep, tracker, elapsed) < 0) {
+				fprintf(stderr, "Out of memory for samples\n");
+				break;
+			}
+			print_sample(&samples.v[samples.count - 1], csv);
+			
+			if (elapsed < warmup)
+				first_checked = samples.count;
+			else
+				failures = check_drift(&samples, first_checked, growth, drift, false);
+			
+			if (now >= end)
+				break;
+			next_sample += (uint64_t)(interval * 1e9);
+		}
+		
+		/* A burst is due once the rate allows for the messages before it */
+		sleep_until(start + (uint64_t)(messages / rate * 1e9));
+		len = nl_gen_fill(&gen, buf, sizeof(buf), BURST, kinds, &count);
+		submit_buffer(ep, buf, len, kinds, count, &errors);
+		messages += count;
+	}
+	
+	event_processor_wait(ep);
+	nlmon_trace_set_sink(NULL, NULL, 0);
+	
+	printf("\nMessages:  %llu (%llu parse errors), %llu handled\n",
+	       (unsigned long long)messages, (unsigned long long)errors,
+	       (unsigned long long)atomic_load(&g_pipeline.handled));
+	if (samples.count - first_checked < MIN_CHECK_SAMPLES)
+		printf("Too few samples after the warmup to check for drift\n");
+	else if (!failures)
+		failures = check_drift(&samples, first_checked, growth, drift, true);
+	
+	/* The allocator's own view, for whoever chases the growth */
+	if (failures)
+		malloc_info(0, stderr);
+	
+	event_processor_destroy(ep, true);
+	resource_tracker_destroy(tracker);
+	hdr_histogram_destroy(g_pipeline.latency);
+	storage_buffer_destroy(g_pipeline.history);
+	filter_bytecode_free(g_pipeline.filter);
+	filter_expr_free(expr);
+	free(samples.v);
+	if (csv)
+		fclose(csv);
+	
+	printf("\nSoak test %s\n", failures ? "FAILED" : "passed");
+	return failures ? 1 : 0;
+	
+usage:
+	fprintf(stderr, USAGE, argv[0]);
+	return 2;
+}
@@ -0,0 +1,156 @@
+/* test_adaptive_batch.c - Unit tests for the adaptive batch controller */
+
+#include "test_framework.h"
+#include "adaptive_batch.h"
+#include "stats_bus.h"
+#include <string.h>
+
+#define MS 1000000ULL
+
+TEST(batch_defaults)
+{
+	struct adaptive_batch_config config = { .max_size = 100, .max_linger_us = 50000 };
+	struct adaptive_batch_stats stats;
+	struct adaptive_batch *batch;
+	
+	batch = adaptive_batch_create("test", &config);
+	ASSERT_NOT_NULL(batch);
+	
+	/* Starts as a fixed batcher would */
+	ASSERT_EQ(adaptive_batch_size(batch), 100);
+	ASSERT_EQ(adaptive_batch_linger_ns(batch), 50 * MS);
+	adaptive_batch_get_stats(batch, &stats);
+	ASSERT_STR_EQ(stats.name, "test");
+	ASSERT_EQ(stats.target_us, 100000);
+	
+	adaptive_batch_destroy(batch);
+}
+
+TEST(batch_shrink_and_grow)
+{
+	struct adaptive_batch_config config = {
+		.min_size = 10,
+		.max_size = 100,
+		.target_us = 10000,
+	};
+	struct adaptive_batch_stats stats;
+	struct adaptive_batch *batch;
+	uint64_t now = 1000 * MS;
+	
+	batch = adaptive_batch_create("test", &config);
+	ASSERT_NOT_NULL(batch);
+	
+	/* Over the target, a quarter off each time down to the minimum */
+	adaptive_batch_record(batch, 100, 0, 20 * MS, now += 100 * MS);
+	ASSERT_EQ(adaptive_batch_size(batch), 75);
+	for (int i = 0; i < 20; i++)
+		adaptive_batch_record(batch, adaptive_batch_size(batch), 0, 20 * MS, now += 100 * MS);
+	ASSERT_EQ(adaptive_batch_size(batch), 10);
+	
+	/* Full and well within it, back up to the maximum */
+	for (int i = 0; i < 20; i++)
+		adaptive_batch_record(batch, adaptive_batch_size(batch), 0, 1 * MS, now += 100 * MS);
+	ASSERT_EQ(adaptive_batch_size(batch), 100);
+	
+	/* Partial batches say nothing about larger ones */
+	adaptive_batch_record(batch, 100, 0, 20 * MS, now += 100 * MS);
+	ASSERT_EQ(adaptive_batch_size(batch), 75);
+	adaptive_batch_record(batch, 5, 0, 1 * MS, now += 100 * MS);
+	ASSERT_EQ(adaptive_batch_size(batch), 75);
+	
+	adaptive_batch_get_stats(batch, &stats);
+	ASSERT_EQ(stats.batches, 43);
+	ASSERT_EQ(stats.over_target, 22);
+	ASSERT_TRUE(stats.shrinks > 0);
+	ASSERT_TRUE(stats.grows > 0);
+	
+	adaptive_batch_destroy(batch);
+}
+
+TEST(batch_linger)
+{
+	struct adaptive_batch_config config = {
+		.max_size = 100,
+		.target_us = 100000,
+		.max_linger_us = 40000,
+	};
+	struct adaptive_batch *batch;
+	uint64_t now = 1000 * MS;
+	
+	batch = adaptive_batch_create("test", &config);
+	ASSERT_NOT_NULL(batch);
+	
+	/* Idle, a batch every second costing a millisecond: no lingering */
+	for (int i = 0; i < 30; i++)
+		adaptive_batch_record(batch, 1, 0, 1 * MS, now += 1000 * MS);
+	ASSERT_EQ(adaptive_batch_linger_ns(batch), 0);
+	
+	/* Busy most of the time: linger grows, up to the maximum */
+	for (int i = 0; i < 30; i++)
+		adaptive_batch_record(batch, 50, 0, 8 * MS, now += 10 * MS);
+	ASSERT_EQ(adaptive_batch_linger_ns(batch), 40 * MS);
+	
+	/* Missing the target halves it */
+	adaptive_batch_record(batch, 50, 100 * MS, 8 * MS, now += 10 * MS);
+	ASSERT_EQ(adaptive_batch_linger_ns(batch), 20 * MS);
+	
+	adaptive_batch_destroy(batch);
+}
+
+TEST(batch_no_linger)
+{
+	struct adaptive_batch *batch;
+	uint64_t now = 1000 * MS;
+	
+	/* Stages that never linger stay that way however busy */
+	batch = adaptive_batch_create("test", NULL);
+	ASSERT_NOT_NULL(batch);
+	ASSERT_EQ(adaptive_batch_size(batch), 256);
+	for (int i = 0; i < 30; i++)
+		adaptive_batch_record(batch, 256, 0, 9 * MS, now += 10 * MS);
+	ASSERT_EQ(adaptive_batch_linger_ns(batch), 0);
+	
+	adaptive_batch_destroy(batch);
+}
+
+TEST(batch_collect)
+{
+	struct nlmon_stats_snapshot snapshot;
+	struct adaptive_batch *a, *b;
+	bool seen_a = false, seen_b = false;
+	
+	a = adaptive_batch_create("stage-a", NULL);
+	b = adaptive_batch_create("stage-b", NULL);
+	ASSERT_NOT_NULL(a);
+	ASSERT_NOT_NULL(b);
+	adaptive_batch_record(a, 3, 0, 1 * MS, 1000 * MS);
+	
+	memset(&snapshot, 0, sizeof(snapshot));
+	adaptive_batch_collect_stats(&snapshot, NULL);
+	ASSERT_TRUE(snapshot.have & STATS_HAVE_BATCHING);
+	for (size_t i = 0; i < snapshot.num_batches; i++) {
+		if (strcmp(snapshot.batches[i].name, "stage-a") == 0) {
+			seen_a = true;
+			ASSERT_EQ(snapshot.batches[i].items, 3);
+		} else if (strcmp(snapshot.batches[i].name, "stage-b") == 0) {
+			seen_b = true;
+		}
+	}
+	ASSERT_TRUE(seen_a);
+	ASSERT_TRUE(seen_b);
+	
+	/* Gone once destroyed */
+	adaptive_batch_destroy(a);
+	adaptive_batch_destroy(b);
+	memset(&snapshot, 0, sizeof(snapshot));
+	adaptive_batch_collect_stats(&snapshot, NULL);
+	ASSERT_EQ(snapshot.num_batches, 0);
+}
+
+TEST_SUITE_BEGIN("Adaptive Batch")
+	RUN_TEST(batch_defaults);
+	RUN_TEST(batch_shrink_and_grow);
+	RUN_TEST(batch_linger);
+	RUN_TEST(batch_no_linger);
+	RUN_TEST(batch_collect);
+TEST_SUITE_END()
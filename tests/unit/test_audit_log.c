@@ -0,0 +1,280 @@
+/* test_audit_log.c - Unit tests for the audit log */
+
+#include "test_framework.h"
+#include "audit_log.h"
+#include "event_processor.h"
+#include "io_service.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_LOG_PATH "/tmp/test_unit_audit_log.log"
+
+static struct audit_log *open_test_log(size_t batch_size, size_t checkpoint_interval)
+{
+	struct audit_log_config config = {
+		.log_path = TEST_LOG_PATH,
+		.batch_size = batch_size,
+		.checkpoint_interval = checkpoint_interval,
+	};
+	
+	return audit_log_open(&config);
+}
+
+static bool write_messages(struct audit_log *log, int first, int count)
+{
+	for (int i = first; i < first + count; i++) {
+		if (!audit_log_write_message(log, AUDIT_INFO, "message %d of the test", i))
+			return false;
+	}
+	
+	return true;
+}
+
+static size_t count_lines(void)
+{
+	FILE *fp = fopen(TEST_LOG_PATH, "r");
+	size_t lines = 0;
+	int c;
+	
+	if (!fp)
+		return 0;
+	
+	while ((c = fgetc(fp)) != EOF) {
+		if (c == '\n')
+			lines++;
+	}
+	
+	fclose(fp);
+	return lines;
+}
+
+/* Change one character near the end of a line, lines counted from 1 */
+static bool tamper_line(size_t line_num)
+{
+	FILE *fp = fopen(TEST_LOG_PATH, "r+");
+	size_t lines = 1;
+	long pos = 0;
+	int c;
+	
+	if (!fp)
+		return false;
+	
+	while (lines < line_num && (c = fgetc(fp)) != EOF) {
+		pos++;
+		if (c == '\n')
+			lines++;
+	}
+	while ((c = fgetc(fp)) != EOF && c != '\n')
+		pos++;
+	
+	/* Last character before the newline */
+	fseek(fp, pos - 1, SEEK_SET);
+	fputc('X', fp);
+	fclose(fp);
+	
+	return lines == line_num;
+}
+
+TEST(audit_log_write_verify)
+{
+	struct audit_log *log;
+	struct nlmon_event event = {0};
+	size_t error_line = 0;
+	
+	unlink(TEST_LOG_PATH);
+	log = open_test_log(0, 0);
+	ASSERT_NOT_NULL(log);
+	
+	event.event_type = 1;
+	event.sequence = 42;
+	strcpy(event.interface, "eth0");
+	ASSERT_TRUE(audit_log_write(log, &event, AUDIT_INFO, NULL));
+	ASSERT_TRUE(write_messages(log, 0, 99));
+	audit_log_close(log);
+	
+	ASSERT_EQ(count_lines(), 100);
+	ASSERT_TRUE(audit_log_verify(TEST_LOG_PATH, &error_line));
+	
+	/* A reopened log continues the chain */
+	log = open_test_log(0, 0);
+	ASSERT_NOT_NULL(log);
+	ASSERT_TRUE(write_messages(log, 99, 50));
+	audit_log_close(log);
+	ASSERT_TRUE(audit_log_verify(TEST_LOG_PATH, &error_line));
+	
+	ASSERT_TRUE(tamper_line(120));
+	ASSERT_FALSE(audit_log_verify(TEST_LOG_PATH, &error_line));
+	ASSERT_EQ(error_line, 121);
+	
+	unlink(TEST_LOG_PATH);
+}
+
+TEST(audit_log_batches)
+{
+	struct audit_log *log;
+	
+	unlink(TEST_LOG_PATH);
+	log = open_test_log(32, 0);
+	ASSERT_NOT_NULL(log);
+	
+	/* Batches reach the file whole */
+	ASSERT_TRUE(write_messages(log, 0, 31));
+	ASSERT_TRUE(audit_log_flush(log));
+	ASSERT_EQ(count_lines(), 31);
+	
+	ASSERT_TRUE(write_messages(log, 31, 40));
+	ASSERT_TRUE(audit_log_flush(log));
+	ASSERT_EQ(count_lines(), 71);
+	
+	ASSERT_TRUE(write_messages(log, 71, 5));
+	audit_log_close(log);
+	ASSERT_EQ(count_lines(), 76);
+	ASSERT_TRUE(audit_log_verify(TEST_LOG_PATH, NULL));
+	
+	unlink(TEST_LOG_PATH);
+}
+
+TEST(audit_log_checkpoints)
+{
+	struct audit_log *log;
+	size_t error_line = 0;
+	uint64_t error_seq = 0;
+	
+	unlink(TEST_LOG_PATH);
+	log = open_test_log(64, 16);
+	ASSERT_NOT_NULL(log);
+	ASSERT_TRUE(write_messages(log, 0, 1000));
+	audit_log_close(log);
+	
+	/* 62 full segments and one of 8, each closed by a checkpoint */
+	ASSERT_EQ(count_lines(), 1000 + 63);
+	ASSERT_TRUE(audit_log_verify(TEST_LOG_PATH, &error_line));
+	ASSERT_TRUE(audit_log_verify_range(TEST_LOG_PATH, 0, 0, &error_seq));
+	ASSERT_TRUE(audit_log_verify_range(TEST_LOG_PATH, 500, 520, &error_seq));
+	ASSERT_TRUE(audit_log_verify_range(TEST_LOG_PATH, 1060, 1062, &error_seq));
+	
+	/* Sequence numbers count lines, checkpoints included */
+	ASSERT_TRUE(tamper_line(601));
+	ASSERT_FALSE(audit_log_verify(TEST_LOG_PATH, &error_line));
+	ASSERT_EQ(error_line, 602);
+	
+	/* The damage shows in the root of its segment, or the chain after it */
+	ASSERT_FALSE(audit_log_verify_range(TEST_LOG_PATH, 595, 597, &error_seq));
+	ASSERT_TRUE(error_seq >= 600 && error_seq <= 611);
+	ASSERT_TRUE(audit_log_verify_range(TEST_LOG_PATH, 100, 300, &error_seq));
+	ASSERT_TRUE(audit_log_verify_range(TEST_LOG_PATH, 700, 900, &error_seq));
+	
+	unlink(TEST_LOG_PATH);
+}
+
+TEST(audit_log_parallel_verify)
+{
+	struct audit_log *log;
+	size_t error_line = 0;
+	size_t lines;
+	
+	/* Several MiB so verification splits into chunks */
+	unlink(TEST_LOG_PATH);
+	log = open_test_log(256, 128);
+	ASSERT_NOT_NULL(log);
+	ASSERT_TRUE(write_messages(log, 0, 40000));
+	audit_log_close(log);
+	
+	lines = count_lines();
+	ASSERT_TRUE(audit_log_verify(TEST_LOG_PATH, &error_line));
+	
+	ASSERT_TRUE(tamper_line(lines - 1000));
+	ASSERT_FALSE(audit_log_verify(TEST_LOG_PATH, &error_line));
+	ASSERT_EQ(error_line, lines - 999);
+	
+	unlink(TEST_LOG_PATH);
+}
+
+/* Append the file at @path to @out */
+static bool append_file(FILE *out, const char *path)
+{
+	FILE *in = fopen(path, "r");
+	char buf[4096];
+	size_t n;
+	
+	if (!in)
+		return false;
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+		fwrite(buf, 1, n, out);
+	fclose(in);
+	
+	return true;
+}
+
+TEST(audit_log_io_service)
+{
+	struct io_service_config io_config = { .buffer_count = 4, .buffer_size = 4096 };
+	struct io_service *io = io_service_create(&io_config);
+	struct audit_log_config config = {
+		.log_path = TEST_LOG_PATH,
+		.batch_size = 64,
+		.checkpoint_interval = 32,
+		.sync_writes = true,
+		.max_file_size = 400 * 1024,
+		.max_rotations = 2,
+		.io_service = io,
+	};
+	struct io_service_stats stats;
+	struct audit_log *log;
+	char rotated[64], joined[64];
+	FILE *fp;
+	
+	ASSERT_NOT_NULL(io);
+	unlink(TEST_LOG_PATH);
+	snprintf(rotated, sizeof(rotated), "%s.0", TEST_LOG_PATH);
+	unlink(rotated);
+	
+	/* Batches span several buffers, in flight out of order */
+	log = audit_log_open(&config);
+	ASSERT_NOT_NULL(log);
+	ASSERT_TRUE(write_messages(log, 0, 1000));
+	ASSERT_TRUE(audit_log_flush(log));
+	ASSERT_TRUE(audit_log_verify(TEST_LOG_PATH, NULL));
+	
+	/* Rotation waits for the writes of the old file */
+	ASSERT_TRUE(write_messages(log, 1000, 3000));
+	audit_log_close(log);
+	ASSERT_TRUE(audit_log_verify(rotated, NULL));
+	
+	/* A reopened log continues at the end of the file */
+	log = audit_log_open(&config);
+	ASSERT_NOT_NULL(log);
+	ASSERT_TRUE(write_messages(log, 4000, 100));
+	audit_log_close(log);
+	
+	/* The chain runs on from the rotated file into the current one */
+	snprintf(joined, sizeof(joined), "%s.joined", TEST_LOG_PATH);
+	fp = fopen(joined, "w");
+	ASSERT_NOT_NULL(fp);
+	ASSERT_TRUE(append_file(fp, rotated));
+	ASSERT_TRUE(append_file(fp, TEST_LOG_PATH));
+	fclose(fp);
+	ASSERT_TRUE(audit_log_verify(joined, NULL));
+	unlink(joined);
+	
+	io_service_get_stats(io, &stats);
+	ASSERT_TRUE(stats.writes > 0);
+	ASSERT_EQ(stats.syncs, stats.writes);
+	ASSERT_EQ(stats.errors, 0);
+	io_service_destroy(io);
+	
+	unlink(TEST_LOG_PATH);
+	unlink(rotated);
+	snprintf(rotated, sizeof(rotated), "%s.1", TEST_LOG_PATH);
+	unlink(rotated);
+}
+
+TEST_SUITE_BEGIN("Audit Log")
+	RUN_TEST(audit_log_write_verify);
+	RUN_TEST(audit_log_batches);
+	RUN_TEST(audit_log_checkpoints);
+	RUN_TEST(audit_log_parallel_verify);
+	RUN_TEST(audit_log_io_service);
+TEST_SUITE_END()
@@ -0,0 +1,145 @@
+/* test_auth_cache.c - Unit tests for the validated token cache */
+
+#include "test_framework.h"
+#include "auth_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static struct auth_identity make_identity(const char *username, uint32_t permissions)
+{
+	struct auth_identity identity;
+	
+	memset(&identity, 0, sizeof(identity));
+	snprintf(identity.username, sizeof(identity.username), "%s", username);
+	snprintf(identity.role, sizeof(identity.role), "viewer");
+	identity.permissions = permissions;
+	return identity;
+}
+
+TEST(auth_cache_hit_and_miss)
+{
+	struct auth_cache *cache = auth_cache_create(64, 60);
+	struct auth_identity identity = make_identity("alice", 0x09);
+	struct auth_identity found;
+	struct auth_cache_stats stats;
+	
+	ASSERT_NOT_NULL(cache);
+	ASSERT_FALSE(auth_cache_lookup(cache, "token-a", &found));
+	
+	auth_cache_insert(cache, "token-a", &identity, 0, auth_cache_generation(cache));
+	ASSERT_TRUE(auth_cache_lookup(cache, "token-a", &found));
+	ASSERT_STR_EQ(found.username, "alice");
+	ASSERT_EQ(found.permissions, 0x09);
+	
+	/* Prefixes and extensions of a cached token do not hit */
+	ASSERT_FALSE(auth_cache_lookup(cache, "token-", NULL));
+	ASSERT_FALSE(auth_cache_lookup(cache, "token-ab", NULL));
+	
+	auth_cache_get_stats(cache, &stats);
+	ASSERT_EQ(stats.entries, 1);
+	ASSERT_EQ(stats.hits, 1);
+	ASSERT_EQ(stats.misses, 3);
+	
+	auth_cache_destroy(cache);
+}
+
+TEST(auth_cache_expiry)
+{
+	struct auth_cache *cache = auth_cache_create(64, 60);
+	struct auth_identity identity = make_identity("bob", 1);
+	struct auth_cache_stats stats;
+	
+	ASSERT_NOT_NULL(cache);
+	
+	/* An already expired token is dropped on lookup */
+	auth_cache_insert(cache, "expired", &identity, time(NULL) - 1, auth_cache_generation(cache));
+	ASSERT_FALSE(auth_cache_lookup(cache, "expired", NULL));
+	auth_cache_get_stats(cache, &stats);
+	ASSERT_EQ(stats.entries, 0);
+	
+	auth_cache_insert(cache, "valid", &identity, time(NULL) + 3600, auth_cache_generation(cache));
+	ASSERT_TRUE(auth_cache_lookup(cache, "valid", NULL));
+	
+	auth_cache_destroy(cache);
+}
+
+TEST(auth_cache_invalidation)
+{
+	struct auth_cache *cache = auth_cache_create(64, 60);
+	struct auth_identity alice = make_identity("alice", 1);
+	struct auth_identity bob = make_identity("bob", 1);
+	uint64_t generation;
+	
+	ASSERT_NOT_NULL(cache);
+	generation = auth_cache_generation(cache);
+	auth_cache_insert(cache, "alice-1", &alice, 0, generation);
+	auth_cache_insert(cache, "alice-2", &alice, 0, generation);
+	auth_cache_insert(cache, "bob-1", &bob, 0, generation);
+	
+	auth_cache_invalidate(cache, "alice-1");
+	ASSERT_FALSE(auth_cache_lookup(cache, "alice-1", NULL));
+	ASSERT_TRUE(auth_cache_lookup(cache, "alice-2", NULL));
+	
+	ASSERT_EQ(auth_cache_invalidate_user(cache, "alice"), 1);
+	ASSERT_FALSE(auth_cache_lookup(cache, "alice-2", NULL));
+	ASSERT_TRUE(auth_cache_lookup(cache, "bob-1", NULL));
+	
+	/* A validation that an invalidation overtook is not cached */
+	generation = auth_cache_generation(cache);
+	auth_cache_invalidate(cache, "alice-3");
+	auth_cache_insert(cache, "alice-3", &alice, 0, generation);
+	ASSERT_FALSE(auth_cache_lookup(cache, "alice-3", NULL));
+	
+	auth_cache_clear(cache);
+	ASSERT_FALSE(auth_cache_lookup(cache, "bob-1", NULL));
+	
+	auth_cache_destroy(cache);
+}
+
+TEST(auth_cache_bounded)
+{
+	struct auth_cache *cache = auth_cache_create(32, 60);
+	struct auth_identity identity = make_identity("carol", 1);
+	struct auth_cache_stats stats;
+	char token[32];
+	size_t hits = 0;
+	
+	ASSERT_NOT_NULL(cache);
+	for (int i = 0; i < 1000; i++) {
+		snprintf(token, sizeof(token), "token-%d", i);
+		auth_cache_insert(cache, token, &identity, 0, auth_cache_generation(cache));
+	}
+	
+	auth_cache_get_stats(cache, &stats);
+	ASSERT_EQ(stats.capacity, 32);
+	ASSERT_TRUE(stats.entries <= stats.capacity);
+	ASSERT_EQ(stats.insertions, 1000);
+	ASSERT_EQ(stats.evictions, 1000 - stats.entries);
+	
+	/* The newest token always survives */
+	ASSERT_TRUE(auth_cache_lookup(cache, "token-999", NULL));
+	for (int i = 0; i < 1000; i++) {
+		snprintf(token, sizeof(token), "token-%d", i);
+		if (auth_cache_lookup(cache, token, NULL))
+			hits++;
+	}
+	ASSERT_EQ(hits, stats.entries);
+	
+	/* Tokens too long to cache are never stored */
+	char long_token[AUTH_CACHE_TOKEN_MAX + 8];
+	memset(long_token, 'x', sizeof(long_token) - 1);
+	long_token[sizeof(long_token) - 1] = '\0';
+	auth_cache_insert(cache, long_token, &identity, 0, auth_cache_generation(cache));
+	ASSERT_FALSE(auth_cache_lookup(cache, long_token, NULL));
+	
+	auth_cache_destroy(cache);
+}
+
+TEST_SUITE_BEGIN("Auth Cache")
+	RUN_TEST(auth_cache_hit_and_miss);
+	RUN_TEST(auth_cache_expiry);
+	RUN_TEST(auth_cache_invalidation);
+	RUN_TEST(auth_cache_bounded);
+TEST_SUITE_END()
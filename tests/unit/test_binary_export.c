@@ -0,0 +1,184 @@
+/* test_binary_export.c - Unit tests for the binary export format */
+
+#include "test_framework.h"
+#include "binary_export.h"
+#include "event_processor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <linux/netlink.h>
+
+#define TEST_FILE "/tmp/test_unit_binary_export.bin"
+
+static const char *const interfaces[] = { "eth0", "eth1", "wlan0", "br-lan" };
+
+/* Write count events, every third with a raw message and nl80211 family */
+static bool write_events(const char *path, int count, bool include_raw)
+{
+	struct binary_export_options options = { .include_raw = include_raw, .buffer_size = 4096 };
+	struct binary_exporter *exporter = binary_exporter_create(path, &options);
+	unsigned char raw[NLMSG_HDRLEN + 12];
+	struct nlmsghdr *nlh = (struct nlmsghdr *)raw;
+	
+	if (!exporter)
+		return false;
+	
+	for (int i = 0; i < count; i++) {
+		struct nlmon_event event = {0};
+		
+		event.timestamp = 1700000000000000ULL + i;
+		event.sequence = i;
+		event.event_type = i % 7;
+		event.message_type = 16 + i % 3;
+		strcpy(event.interface, interfaces[i % 4]);
+		event.netlink.protocol = i % 3 ? NETLINK_ROUTE : NETLINK_GENERIC;
+		event.netlink.msg_type = 16 + i % 3;
+		event.netlink.msg_flags = NLM_F_MULTI;
+		event.netlink.seq = 1000 + i;
+		event.netlink.pid = 42;
+		
+		if (i % 3 == 0) {
+			event.netlink.genl_cmd = 7;
+			event.netlink.genl_version = 1;
+			event.netlink.genl_family_id = 28;
+			strcpy(event.netlink.genl_family_name, "nl80211");
+			
+			memset(raw, i & 0xff, sizeof(raw));
+			nlh->nlmsg_len = sizeof(raw) - (i % 5);
+			event.raw_msg = nlh;
+			event.raw_msg_len = nlh->nlmsg_len;
+		}
+		
+		if (!binary_exporter_write_event(exporter, &event)) {
+			binary_exporter_destroy(exporter);
+			return false;
+		}
+	}
+	
+	binary_exporter_destroy(exporter);
+	return true;
+}
+
+TEST(binary_export_roundtrip)
+{
+	struct binary_reader_event ev;
+	struct binary_reader *reader;
+	struct stat st;
+	int count = 0;
+	
+	unlink(TEST_FILE);
+	ASSERT_TRUE(write_events(TEST_FILE, 1000, true));
+	
+	reader = binary_reader_open(TEST_FILE);
+	ASSERT_NOT_NULL(reader);
+	ASSERT_TRUE(binary_reader_created(reader) > 0);
+	
+	while (binary_reader_next(reader, &ev)) {
+		int i = count++;
+		
+		ASSERT_EQ(ev.event->timestamp, 1700000000000000ULL + i);
+		ASSERT_EQ(ev.event->sequence, (uint64_t)i);
+		ASSERT_EQ(ev.event->event_type, (uint32_t)(i % 7));
+		ASSERT_EQ(ev.event->message_type, 16 + i % 3);
+		ASSERT_STR_EQ(ev.interface, interfaces[i % 4]);
+		ASSERT_EQ(ev.event->nl_seq, (uint32_t)(1000 + i));
+		ASSERT_EQ(ev.event->nl_pid, 42);
+		ASSERT_EQ(ev.event->nl_msg_flags, NLM_F_MULTI);
+		
+		if (i % 3 == 0) {
+			ASSERT_EQ(ev.event->nl_protocol, NETLINK_GENERIC);
+			ASSERT_STR_EQ(ev.genl_family, "nl80211");
+			ASSERT_EQ(ev.event->genl_family_id, 28);
+			ASSERT_EQ(ev.event->genl_cmd, 7);
+			ASSERT_NOT_NULL(ev.raw);
+			ASSERT_EQ(ev.raw_len, NLMSG_HDRLEN + 12 - (size_t)(i % 5));
+			ASSERT_EQ(((const unsigned char *)ev.raw)[ev.raw_len - 1], i & 0xff);
+			ASSERT_EQ(((const uintptr_t)ev.raw) % 8, 0);
+		} else {
+			ASSERT_STR_EQ(ev.genl_family, "");
+			ASSERT_NULL(ev.raw);
+			ASSERT_EQ(ev.raw_len, 0);
+		}
+	}
+	ASSERT_EQ(count, 1000);
+	
+	/* The dictionary is rebuilt on a second pass */
+	binary_reader_rewind(reader);
+	ASSERT_TRUE(binary_reader_next(reader, &ev));
+	ASSERT_EQ(ev.event->sequence, 0);
+	ASSERT_STR_EQ(ev.interface, "eth0");
+	binary_reader_close(reader);
+	
+	/* Without raw messages an event is one 64 byte record */
+	ASSERT_TRUE(write_events(TEST_FILE, 1000, false));
+	ASSERT_EQ(stat(TEST_FILE, &st), 0);
+	ASSERT_TRUE(st.st_size < 1000 * 64 + 1024);
+	
+	unlink(TEST_FILE);
+}
+
+TEST(binary_export_truncated_tail)
+{
+	struct binary_reader_event ev;
+	struct binary_reader *reader;
+	struct stat st;
+	int count = 0;
+	
+	unlink(TEST_FILE);
+	ASSERT_TRUE(write_events(TEST_FILE, 10, false));
+	
+	/* A crash in the middle of the last record */
+	ASSERT_EQ(stat(TEST_FILE, &st), 0);
+	ASSERT_EQ(truncate(TEST_FILE, st.st_size - 20), 0);
+	
+	reader = binary_reader_open(TEST_FILE);
+	ASSERT_NOT_NULL(reader);
+	while (binary_reader_next(reader, &ev))
+		count++;
+	ASSERT_EQ(count, 9);
+	ASSERT_FALSE(binary_reader_next(reader, &ev));
+	binary_reader_close(reader);
+	
+	unlink(TEST_FILE);
+}
+
+TEST(binary_export_schema_mismatch)
+{
+	struct binary_reader *reader;
+	char byte = 'X';
+	int fd;
+	
+	unlink(TEST_FILE);
+	ASSERT_TRUE(write_events(TEST_FILE, 3, false));
+	
+	/* Rename the first schema field */
+	fd = open(TEST_FILE, O_WRONLY);
+	ASSERT_TRUE(fd >= 0);
+	ASSERT_EQ(pwrite(fd, &byte, 1, sizeof(struct binexp_file_header)), 1);
+	close(fd);
+	
+	errno = 0;
+	reader = binary_reader_open(TEST_FILE);
+	ASSERT_NULL(reader);
+	ASSERT_EQ(errno, EPROTO);
+	
+	/* Not an export file at all */
+	fd = open(TEST_FILE, O_WRONLY | O_TRUNC);
+	ASSERT_TRUE(fd >= 0);
+	ASSERT_EQ(write(fd, "hello", 5), 5);
+	close(fd);
+	ASSERT_NULL(binary_reader_open(TEST_FILE));
+	ASSERT_EQ(errno, EPROTO);
+	
+	unlink(TEST_FILE);
+}
+
+TEST_SUITE_BEGIN("Binary Export")
+	RUN_TEST(binary_export_roundtrip);
+	RUN_TEST(binary_export_truncated_tail);
+	RUN_TEST(binary_export_schema_mismatch);
+TEST_SUITE_END()
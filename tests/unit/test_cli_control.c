@@ -0,0 +1,329 @@
+/* test_cli_control.c - Unit tests for the control protocol */
+
+#include "test_framework.h"
+#include "cli_control.h"
+#include "filter_manager.h"
+#include "event_processor.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static void socket_path(char *path, size_t len)
+{
+	snprintf(path, len, "/tmp/test_cli_control.%d.sock", (int)getpid());
+}
+
+static void make_event(struct nlmon_event *event, const char *interface)
+{
+	memset(event, 0, sizeof(*event));
+	snprintf(event->interface, sizeof(event->interface), "%s", interface);
+}
+
+/* Next event of a subscription, false after timeout_ms without one */
+static bool next_event(int fd, struct cli_control_event *ev, int timeout_ms)
+{
+	struct cli_control_hdr hdr;
+	ssize_t n;
+	
+	do {
+		n = cli_control_recv(fd, &hdr, ev, sizeof(*ev), timeout_ms);
+		if (n <= 0)
+			return false;
+	} while (hdr.type != CLI_CONTROL_EVENT);
+	return (size_t)n == sizeof(*ev);
+}
+
+/* Send a query and count its events, the last one copied to last */
+static int run_query(int fd, const struct cli_control_query *query,
+                     struct cli_control_event *last)
+{
+	struct cli_control_event ev;
+	struct cli_control_hdr hdr;
+	int count = 0;
+	
+	if (cli_control_send(fd, CLI_CONTROL_QUERY, 7, query, sizeof(*query)) < 0)
+		return -1;
+	for (;;) {
+		if (cli_control_recv(fd, &hdr, &ev, sizeof(ev), 2000) < 0 || !hdr.type)
+			return -1;
+		if (hdr.id != 7)
+			continue;
+		if (hdr.type == CLI_CONTROL_END)
+			return count;
+		count++;
+		*last = ev;
+	}
+}
+
+TEST(cli_control_stats)
+{
+	struct cli_control_server *srv;
+	struct cli_control_stats stats;
+	char path[64];
+	int fd, fd2;
+	
+	socket_path(path, sizeof(path));
+	srv = cli_control_server_create(path, NULL);
+	ASSERT_NOT_NULL(srv);
+	
+	/* A second server on a live socket is refused */
+	ASSERT_NULL(cli_control_server_create(path, NULL));
+	
+	fd = cli_control_connect(path);
+	ASSERT_TRUE(fd >= 0);
+	fd2 = cli_control_connect(path);
+	ASSERT_TRUE(fd2 >= 0);
+	
+	cli_control_publish(srv, NULL, "link", "eth0", "eth0 up");
+	cli_control_publish(srv, NULL, "route", "eth0", "default via 10.0.0.1");
+	usleep(50000);
+	
+	ASSERT_EQ(cli_control_call(fd, CLI_CONTROL_STATS, NULL, 0, &stats, sizeof(stats)), 0);
+	ASSERT_EQ(stats.published, 2);
+	ASSERT_EQ(stats.link_events, 1);
+	ASSERT_EQ(stats.route_events, 1);
+	ASSERT_EQ(stats.clients, 2);
+	ASSERT_EQ(stats.subscribers, 0);
+	ASSERT_EQ(stats.have_bus, 0);
+	
+	/* Without a filter manager there are no filters to manage */
+	ASSERT_EQ(cli_control_call(fd, CLI_CONTROL_FILTER_LIST, NULL, 0, NULL, 0), -EOPNOTSUPP);
+	ASSERT_EQ(cli_control_call(fd, 200, NULL, 0, NULL, 0), -EOPNOTSUPP);
+	
+	close(fd);
+	close(fd2);
+	cli_control_server_destroy(srv);
+	ASSERT_TRUE(access(path, F_OK) < 0);
+}
+
+TEST(cli_control_subscribe_and_query)
+{
+	struct cli_control_server *srv;
+	struct cli_control_filter all;
+	struct cli_control_query query;
+	struct cli_control_event ev;
+	char path[64], message[32];
+	int fd;
+	
+	socket_path(path, sizeof(path));
+	srv = cli_control_server_create(path, NULL);
+	ASSERT_NOT_NULL(srv);
+	fd = cli_control_connect(path);
+	ASSERT_TRUE(fd >= 0);
+	
+	memset(&all, 0, sizeof(all));
+	ASSERT_FALSE(cli_control_has_subscribers(srv));
+	ASSERT_EQ(cli_control_call(fd, CLI_CONTROL_SUBSCRIBE, &all, sizeof(all), NULL, 0), 0);
+	ASSERT_TRUE(cli_control_has_subscribers(srv));
+	
+	for (int i = 0; i < 10; i++) {
+		snprintf(message, sizeof(message), "event %d", i);
+		cli_control_publish(srv, NULL, i % 2 ? "link" : "addr", i < 5 ? "eth0" : "eth1",
+		                    message);
+	}
+	for (int i = 0; i < 10; i++) {
+		snprintf(message, sizeof(message), "event %d", i);
+		ASSERT_TRUE(next_event(fd, &ev, 2000));
+		ASSERT_STR_EQ(ev.message, message);
+		ASSERT_EQ(ev.seq, (uint64_t)i + 1);
+		ASSERT_EQ(ev.missed, 0);
+	}
+	
+	ASSERT_EQ(cli_control_call(fd, CLI_CONTROL_UNSUBSCRIBE, NULL, 0, NULL, 0), 0);
+	ASSERT_FALSE(cli_control_has_subscribers(srv));
+	
+	/* Everything kept, then a selection, newest first when limited */
+	memset(&query, 0, sizeof(query));
+	ASSERT_EQ(run_query(fd, &query, &ev), 10);
+	ASSERT_STR_EQ(ev.message, "event 9");
+	
+	snprintf(query.interface, sizeof(query.interface), "eth1");
+	snprintf(query.event_type, sizeof(query.event_type), "link");
+	ASSERT_EQ(run_query(fd, &query, &ev), 3);
+	
+	query.max_results = 2;
+	ASSERT_EQ(run_query(fd, &query, &ev), 2);
+	ASSERT_STR_EQ(ev.message, "event 9");
+	
+	memset(&query, 0, sizeof(query));
+	query.after_seq = 8;
+	ASSERT_EQ(run_query(fd, &query, &ev), 2);
+	snprintf(query.text, sizeof(query.text), "nothing");
+	ASSERT_EQ(run_query(fd, &query, &ev), 0);
+	
+	close(fd);
+	cli_control_server_destroy(srv);
+}
+
+TEST(cli_control_filters)
+{
+	struct cli_control_context ctx = { 0 };
+	struct cli_control_server *srv;
+	struct cli_control_filter filter;
+	struct cli_control_event ev;
+	struct cli_control_hdr hdr;
+	struct nlmon_event event;
+	char path[64], error[CLI_CONTROL_MAX_PACKET];
+	int fd, count = 0;
+	
+	ctx.filter_mgr = filter_manager_create(NULL);
+	ASSERT_NOT_NULL(ctx.filter_mgr);
+	socket_path(path, sizeof(path));
+	srv = cli_control_server_create(path, &ctx);
+	ASSERT_NOT_NULL(srv);
+	fd = cli_control_connect(path);
+	ASSERT_TRUE(fd >= 0);
+	
+	/* Invalid expressions are refused with the parser's error */
+	memset(&filter, 0, sizeof(filter));
+	snprintf(filter.name, sizeof(filter.name), "eth0");
+	snprintf(filter.expression, sizeof(filter.expression), "interface ==");
+	memset(error, 0, sizeof(error));
+	ASSERT_EQ(cli_control_call(fd, CLI_CONTROL_FILTER_ADD, &filter, sizeof(filter),
+	                           error, sizeof(error) - 1), -EINVAL);
+	ASSERT_TRUE(error[0] != '\0');
+	
+	snprintf(filter.expression, sizeof(filter.expression), "interface == \"eth0\"");
+	filter.enabled = 1;
+	ASSERT_EQ(cli_control_call(fd, CLI_CONTROL_FILTER_ADD, &filter, sizeof(filter), NULL, 0), 0);
+	ASSERT_NOT_NULL(filter_manager_get(ctx.filter_mgr, "eth0"));
+	
+	/* Listed, then END */
+	ASSERT_EQ(cli_control_send(fd, CLI_CONTROL_FILTER_LIST, 3, NULL, 0), 0);
+	for (;;) {
+		memset(&filter, 0, sizeof(filter));
+		ASSERT_TRUE(cli_control_recv(fd, &hdr, &filter, sizeof(filter), 2000) >= 0);
+		ASSERT_EQ(hdr.id, 3);
+		if (hdr.type == CLI_CONTROL_END)
+			break;
+		ASSERT_EQ(hdr.type, CLI_CONTROL_FILTER);
+		ASSERT_STR_EQ(filter.name, "eth0");
+		ASSERT_STR_EQ(filter.expression, "interface == \"eth0\"");
+		ASSERT_EQ(filter.enabled, 1);
+		count++;
+	}
+	ASSERT_EQ(count, 1);
+	
+	/* Subscriptions name an existing filter and get what it matches */
+	memset(&filter, 0, sizeof(filter));
+	snprintf(filter.name, sizeof(filter.name), "missing");
+	ASSERT_EQ(cli_control_call(fd, CLI_CONTROL_SUBSCRIBE, &filter, sizeof(filter), NULL, 0),
+	          -ENOENT);
+	snprintf(filter.name, sizeof(filter.name), "eth0");
+	ASSERT_EQ(cli_control_call(fd, CLI_CONTROL_SUBSCRIBE, &filter, sizeof(filter), NULL, 0), 0);
+	
+	make_event(&event, "eth1");
+	cli_control_publish(srv, &event, "link", "eth1", "eth1 up");
+	cli_control_publish(srv, NULL, "log", "", "no event");
+	make_event(&event, "eth0");
+	cli_control_publish(srv, &event, "link", "eth0", "eth0 up");
+	ASSERT_TRUE(next_event(fd, &ev, 2000));
+	ASSERT_STR_EQ(ev.message, "eth0 up");
+	ASSERT_EQ(ev.seq, 3);
+	
+	ASSERT_EQ(cli_control_call(fd, CLI_CONTROL_FILTER_REMOVE, &filter, sizeof(filter), NULL, 0), 0);
+	ASSERT_EQ(cli_control_call(fd, CLI_CONTROL_FILTER_REMOVE, &filter, sizeof(filter), NULL, 0),
+	          -ENOENT);
+	ASSERT_NULL(filter_manager_get(ctx.filter_mgr, "eth0"));
+	
+	close(fd);
+	cli_control_server_destroy(srv);
+	filter_manager_destroy(ctx.filter_mgr);
+}
+
+/* Published without reading, far more than the feed and socket hold */
+#define SLOW_PUBLISHED 20000
+
+struct slow_subscriber {
+	int fd;
+	pthread_barrier_t barrier;
+	uint64_t seen;
+	uint64_t missed;
+	bool got_last;
+};
+
+static void *slow_subscriber_thread(void *arg)
+{
+	struct slow_subscriber *sub = arg;
+	struct cli_control_event ev;
+	
+	/* Held back until the publisher overfilled the feed */
+	pthread_barrier_wait(&sub->barrier);
+	while (next_event(sub->fd, &ev, 100)) {
+		sub->seen++;
+		sub->missed += ev.missed;
+	}
+	
+	/* With room again, the next event reports what was lost */
+	pthread_barrier_wait(&sub->barrier);
+	while (next_event(sub->fd, &ev, 2000)) {
+		sub->seen++;
+		sub->missed += ev.missed;
+		if (strcmp(ev.message, "last") == 0) {
+			sub->got_last = true;
+			break;
+		}
+	}
+	return NULL;
+}
+
+TEST(cli_control_slow_subscriber)
+{
+	struct cli_control_server *srv;
+	struct cli_control_filter all;
+	struct cli_control_stats stats;
+	struct slow_subscriber sub = { 0 };
+	pthread_t thread;
+	char path[64];
+	int ctl;
+	
+	socket_path(path, sizeof(path));
+	srv = cli_control_server_create(path, NULL);
+	ASSERT_NOT_NULL(srv);
+	sub.fd = cli_control_connect(path);
+	ASSERT_TRUE(sub.fd >= 0);
+	ctl = cli_control_connect(path);
+	ASSERT_TRUE(ctl >= 0);
+	
+	memset(&all, 0, sizeof(all));
+	ASSERT_EQ(cli_control_call(sub.fd, CLI_CONTROL_SUBSCRIBE, &all, sizeof(all), NULL, 0), 0);
+	pthread_barrier_init(&sub.barrier, NULL, 2);
+	pthread_create(&thread, NULL, slow_subscriber_thread, &sub);
+	
+	for (int i = 0; i < SLOW_PUBLISHED; i++)
+		cli_control_publish(srv, NULL, "link", "eth0", "flap");
+	
+	/* The server loses events once it drains the feed into the full socket */
+	for (int wait = 0; wait < 200; wait++) {
+		ASSERT_EQ(cli_control_call(ctl, CLI_CONTROL_STATS, NULL, 0, &stats, sizeof(stats)), 0);
+		if (stats.dropped + stats.missed > 0)
+			break;
+		usleep(10000);
+	}
+	pthread_barrier_wait(&sub.barrier);
+	
+	pthread_barrier_wait(&sub.barrier);
+	cli_control_publish(srv, NULL, "link", "eth0", "last");
+	pthread_join(thread, NULL);
+	pthread_barrier_destroy(&sub.barrier);
+	
+	ASSERT_TRUE(stats.dropped + stats.missed > 0);
+	ASSERT_TRUE(sub.got_last);
+	
+	/* Every event was either received or counted as missed */
+	ASSERT_TRUE(sub.missed > 0);
+	ASSERT_EQ(sub.seen + sub.missed, SLOW_PUBLISHED + 1);
+	
+	close(sub.fd);
+	close(ctl);
+	cli_control_server_destroy(srv);
+}
+
+TEST_SUITE_BEGIN("CLI Control")
+	RUN_TEST(cli_control_stats);
+	RUN_TEST(cli_control_subscribe_and_query);
+	RUN_TEST(cli_control_filters);
+	RUN_TEST(cli_control_slow_subscriber);
+TEST_SUITE_END()
@@ -0,0 +1,111 @@
+/* test_correlation_engine.c - Unit tests for correlation records and IDs */
+
+#include "test_framework.h"
+#include "correlation_engine.h"
+#include "event_processor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define ID_THREADS 4
+#define IDS_PER_THREAD 100000
+
+static int compare_ids(const void *a, const void *b)
+{
+	correlation_id_t x = *(const correlation_id_t *)a, y = *(const correlation_id_t *)b;
+	
+	return x < y ? -1 : x > y;
+}
+
+static void *take_ids(void *arg)
+{
+	correlation_id_t *ids = arg;
+	
+	for (int i = 0; i < IDS_PER_THREAD; i++)
+		ids[i] = correlation_id_next();
+	return NULL;
+}
+
+TEST(correlation_ids_unique_across_threads)
+{
+	correlation_id_t *ids = malloc(sizeof(*ids) * ID_THREADS * IDS_PER_THREAD);
+	pthread_t threads[ID_THREADS];
+	
+	ASSERT_NOT_NULL(ids);
+	
+	for (int t = 0; t < ID_THREADS; t++)
+		ASSERT_EQ(pthread_create(&threads[t], NULL, take_ids, ids + t * IDS_PER_THREAD), 0);
+	for (int t = 0; t < ID_THREADS; t++)
+		pthread_join(threads[t], NULL);
+	
+	/* A thread's IDs increase and its first block is its own */
+	for (int t = 0; t < ID_THREADS; t++) {
+		correlation_id_t *own = ids + t * IDS_PER_THREAD;
+	
+		for (int i = 1; i < IDS_PER_THREAD; i++)
+			ASSERT_TRUE(own[i] > own[i - 1]);
+		for (int u = 0; u < t; u++)
+			ASSERT_TRUE(own[0] >> CORRELATION_ID_BLOCK_BITS !=
+			            ids[u * IDS_PER_THREAD] >> CORRELATION_ID_BLOCK_BITS);
+	}
+	
+	qsort(ids, ID_THREADS * IDS_PER_THREAD, sizeof(*ids), compare_ids);
+	ASSERT_TRUE(ids[0] != 0);
+	for (int i = 1; i < ID_THREADS * IDS_PER_THREAD; i++)
+		ASSERT_TRUE(ids[i] != ids[i - 1]);
+	
+	free(ids);
+}
+
+TEST(correlation_records)
+{
+	struct correlation_config config = {
+		.max_window_size = 100,
+		.default_window_sec = 60,
+		.max_rules = 4,
+	};
+	struct correlation_rule_def rule = {
+		.name = "link-flap",
+		.event_count = 2,
+		.condition_count = 1,
+		.time_window_sec = 60,
+	};
+	struct correlation_result results[4];
+	struct correlation_engine *engine = correlation_engine_create(&config);
+	struct nlmon_event event;
+	char text[32];
+	int id;
+	
+	ASSERT_NOT_NULL(engine);
+	rule.conditions[0].type = CORR_COND_SAME_INTERFACE;
+	id = correlation_engine_add_rule(engine, &rule);
+	ASSERT_TRUE(id >= 0);
+	
+	memset(&event, 0, sizeof(event));
+	event.timestamp = 1000;
+	snprintf(event.interface, sizeof(event.interface), "eth0");
+	ASSERT_EQ(correlation_engine_process(engine, &event, results, 4), 0);
+	ASSERT_EQ(correlation_engine_process(engine, &event, results, 4), 1);
+	ASSERT_EQ(correlation_engine_process(engine, &event, results + 1, 3), 1);
+	
+	/* Records refer to the rule and carry their own IDs */
+	ASSERT_EQ(results[0].rule_id, id);
+	ASSERT_STR_EQ(results[0].rule_name, "link-flap");
+	ASSERT_TRUE(results[0].rule_name == results[1].rule_name);
+	ASSERT_EQ(results[0].event_count, 2);
+	ASSERT_EQ(results[1].event_count, 3);
+	ASSERT_EQ(results[0].last_timestamp, 1000);
+	ASSERT_TRUE(results[0].id != 0);
+	ASSERT_TRUE(results[1].id > results[0].id);
+	
+	snprintf(text, sizeof(text), CORRELATION_ID_FMT, results[0].id);
+	ASSERT_EQ(strlen(text), 16);
+	
+	correlation_engine_destroy(engine);
+}
+
+TEST_SUITE_BEGIN("Correlation Engine")
+	RUN_TEST(correlation_ids_unique_across_threads);
+	RUN_TEST(correlation_records);
+TEST_SUITE_END()
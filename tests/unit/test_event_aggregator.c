@@ -0,0 +1,240 @@
+/* test_event_aggregator.c - Unit tests for the multi-node event aggregator */
+
+#include "test_framework.h"
+#include "event_aggregator.h"
+#include "event_processor.h"
+#include "correlation_engine.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/netlink.h>
+
+#define NODES 3
+
+struct merged {
+	_Atomic uint64_t count;         /* Polled while the aggregator runs */
+	uint64_t out_of_order;
+	uint64_t last_ts;
+	uint64_t per_node[NODES];
+	uint64_t node_mismatch;
+	uint64_t correlations;
+	bool slow;                      /* Take a while over each event */
+};
+
+static void fill_event(struct nlmon_event *event, int node, int i)
+{
+	memset(event, 0, sizeof(*event));
+	/* Timestamps of the nodes interleave */
+	event->timestamp = 1700000000000000ULL + (uint64_t)i * NODES + node;
+	event->sequence = i;
+	event->event_type = node == 0 && i == 0 ? 9 : 1;
+	event->message_type = 16;
+	snprintf(event->interface, sizeof(event->interface), "eth%d", node);
+	event->netlink.protocol = NETLINK_ROUTE;
+	event->netlink.msg_type = 16;
+}
+
+static void on_event(const char *node, struct nlmon_event *event, void *ctx)
+{
+	struct merged *merged = ctx;
+	int n = node[4] - 'a';
+	
+	if (event->timestamp < merged->last_ts)
+		merged->out_of_order++;
+	merged->last_ts = event->timestamp;
+	atomic_fetch_add(&merged->count, 1);
+	if (n < 0 || n >= NODES || event->interface[3] - '0' != n || event->user_data != node)
+		merged->node_mismatch++;
+	else
+		merged->per_node[n]++;
+	if (merged->slow)
+		usleep(100);
+}
+
+static void on_correlation(const char *node, const struct correlation_result *results,
+                           size_t count, void *ctx)
+{
+	struct merged *merged = ctx;
+	
+	merged->correlations += count;
+}
+
+static struct event_stream *stream_start(struct event_aggregator *agg, int node)
+{
+	char name[16];
+	struct event_stream_config config = {
+		.server = "127.0.0.1",
+		.port = event_aggregator_port(agg),
+		.node = name,
+		.batch_events = 50,
+	};
+	
+	snprintf(name, sizeof(name), "node%c", 'a' + node);
+	return event_stream_create(&config);
+}
+
+static bool wait_in(struct event_aggregator *agg, struct event_stream **streams, uint64_t count)
+{
+	struct event_aggregator_stats stats;
+	
+	for (int i = 0; i < 500; i++) {
+		for (int n = 0; n < NODES; n++)
+			event_stream_flush(streams[n]);
+		event_aggregator_get_stats(agg, &stats);
+		if (stats.events_in >= count)
+			return stats.events_in == count;
+		usleep(10000);
+	}
+	return false;
+}
+
+/* Nodes sending their streams one after the other come out interleaved */
+TEST(event_aggregator_merge_order)
+{
+	struct event_aggregator_config config = {
+		.collector = { .bind_addr = "127.0.0.1", .any_port = true, .workers = 2 },
+		.reorder_delay_ms = 5000,
+		.fn = on_event,
+	};
+	struct event_stream *streams[NODES];
+	struct event_aggregator_stats stats;
+	struct event_aggregator *agg;
+	struct merged merged = {0};
+	struct nlmon_event event;
+	
+	config.ctx = &merged;
+	agg = event_aggregator_create(&config);
+	ASSERT_NOT_NULL(agg);
+	
+	/* Every node is heard from first */
+	for (int n = 0; n < NODES; n++) {
+		streams[n] = stream_start(agg, n);
+		ASSERT_NOT_NULL(streams[n]);
+		fill_event(&event, n, 0);
+		ASSERT_TRUE(event_stream_write_event(streams[n], &event));
+	}
+	ASSERT_TRUE(wait_in(agg, streams, NODES));
+	
+	/* Then each sends its rest, which waits for the others */
+	for (int n = 0; n < NODES; n++) {
+		for (int i = 1; i < 500; i++) {
+			fill_event(&event, n, i);
+			ASSERT_TRUE(event_stream_write_event(streams[n], &event));
+		}
+		event_stream_flush(streams[n]);
+	}
+	ASSERT_TRUE(wait_in(agg, streams, NODES * 500));
+	
+	for (int n = 0; n < NODES; n++)
+		event_stream_destroy(streams[n]);
+	event_aggregator_get_stats(agg, &stats);
+	ASSERT_EQ(stats.nodes, NODES);
+	ASSERT_EQ(stats.collector.nodes, NODES);
+	ASSERT_TRUE(stats.buffered_max > 0);
+	
+	/* What is still buffered comes out on destroy */
+	event_aggregator_destroy(agg);
+	ASSERT_EQ(atomic_load(&merged.count), NODES * 500);
+	ASSERT_EQ(merged.out_of_order, 0);
+	ASSERT_EQ(merged.node_mismatch, 0);
+	for (int n = 0; n < NODES; n++)
+		ASSERT_EQ(merged.per_node[n], 500);
+}
+
+/* A full reorder buffer holds the collector back instead of dropping */
+TEST(event_aggregator_bounded)
+{
+	struct event_aggregator_config config = {
+		.collector = { .bind_addr = "127.0.0.1", .any_port = true, .workers = 1 },
+		.reorder_delay_ms = 5000,
+		.reorder_capacity = 100,
+		.fn = on_event,
+	};
+	struct event_aggregator_stats stats;
+	struct event_aggregator *agg;
+	struct event_stream *stream;
+	struct merged merged = { .slow = true };
+	struct nlmon_event event;
+	
+	config.ctx = &merged;
+	agg = event_aggregator_create(&config);
+	ASSERT_NOT_NULL(agg);
+	stream = stream_start(agg, 0);
+	ASSERT_NOT_NULL(stream);
+	
+	for (int i = 0; i < 2000; i++) {
+		fill_event(&event, 0, i);
+		ASSERT_TRUE(event_stream_write_event(stream, &event));
+	}
+	for (int i = 0; i < 500 && atomic_load(&merged.count) < 2000; i++) {
+		event_stream_flush(stream);
+		usleep(10000);
+	}
+	
+	event_aggregator_get_stats(agg, &stats);
+	ASSERT_EQ(stats.events_in, 2000);
+	ASSERT_EQ(stats.dropped, 0);
+	ASSERT_TRUE(stats.buffered_max <= 100);
+	ASSERT_TRUE(stats.stalls > 0);
+	
+	event_stream_destroy(stream);
+	event_aggregator_destroy(agg);
+	ASSERT_EQ(atomic_load(&merged.count), 2000);
+	ASSERT_EQ(merged.out_of_order, 0);
+}
+
+/* A rule over all events sees the events of every node */
+TEST(event_aggregator_correlation)
+{
+	struct correlation_config corr_config = {
+		.max_window_size = 1000,
+		.default_window_sec = 60,
+		.max_rules = 4,
+	};
+	struct correlation_rule_def rule = {
+		.name = "cross-node",
+		.event_count = NODES,
+		.condition_count = 1,
+		.time_window_sec = 60,
+	};
+	struct event_aggregator_config config = {
+		.collector = { .bind_addr = "127.0.0.1", .any_port = true },
+		.reorder_delay_ms = 50,
+		.on_correlation = on_correlation,
+	};
+	struct event_stream *streams[NODES];
+	struct event_aggregator *agg;
+	struct merged merged = {0};
+	struct nlmon_event event;
+	
+	config.correlation = correlation_engine_create(&corr_config);
+	ASSERT_NOT_NULL(config.correlation);
+	rule.conditions[0].type = CORR_COND_MESSAGE_TYPE;
+	rule.conditions[0].value.message_type = 16;
+	ASSERT_TRUE(correlation_engine_add_rule(config.correlation, &rule) >= 0);
+	
+	config.ctx = &merged;
+	agg = event_aggregator_create(&config);
+	ASSERT_NOT_NULL(agg);
+	for (int n = 0; n < NODES; n++) {
+		streams[n] = stream_start(agg, n);
+		ASSERT_NOT_NULL(streams[n]);
+		fill_event(&event, n, 0);
+		ASSERT_TRUE(event_stream_write_event(streams[n], &event));
+	}
+	ASSERT_TRUE(wait_in(agg, streams, NODES));
+	
+	for (int n = 0; n < NODES; n++)
+		event_stream_destroy(streams[n]);
+	event_aggregator_destroy(agg);
+	ASSERT_TRUE(merged.correlations > 0);
+	correlation_engine_destroy(config.correlation);
+}
+
+TEST_SUITE_BEGIN("Event Aggregator")
+	RUN_TEST(event_aggregator_merge_order);
+	RUN_TEST(event_aggregator_bounded);
+	RUN_TEST(event_aggregator_correlation);
+TEST_SUITE_END()
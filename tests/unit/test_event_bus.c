@@ -0,0 +1,262 @@
+/* test_event_bus.c - Unit tests for the shared memory event bus */
+
+#include "test_framework.h"
+#include "event_bus.h"
+#include "event_processor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <linux/netlink.h>
+
+#define TEST_BUS "/test_unit_event_bus"
+
+static void fill_event(struct nlmon_event *event, int i)
+{
+	memset(event, 0, sizeof(*event));
+	event->timestamp = 1700000000000000ULL + i;
+	event->sequence = i;
+	event->event_type = i % 7;
+	event->message_type = 16 + i % 3;
+	snprintf(event->interface, sizeof(event->interface), "eth%d", i % 4);
+	event->netlink.protocol = NETLINK_GENERIC;
+	event->netlink.msg_type = 16 + i % 3;
+	event->netlink.seq = 1000 + i;
+	event->netlink.pid = 42;
+	strcpy(event->netlink.genl_family_name, "nl80211");
+}
+
+TEST(event_bus_roundtrip)
+{
+	struct event_bus_options options = { .slots = 8, .include_raw = true };
+	unsigned char raw[NLMSG_HDRLEN + 12], buf[1024];
+	const struct event_bus_record *rec;
+	struct event_bus_reader *reader;
+	struct event_bus_stats stats;
+	struct nlmon_event event;
+	struct event_bus *bus;
+	
+	bus = event_bus_create(TEST_BUS, &options);
+	ASSERT_NOT_NULL(bus);
+	reader = event_bus_reader_open(TEST_BUS, 0);
+	ASSERT_NOT_NULL(reader);
+	ASSERT_EQ(event_bus_reader_peek(reader, &rec), -EAGAIN);
+	
+	fill_event(&event, 1);
+	memset(raw, 0xab, sizeof(raw));
+	((struct nlmsghdr *)raw)->nlmsg_len = sizeof(raw);
+	event.raw_msg = (struct nlmsghdr *)raw;
+	event.raw_msg_len = sizeof(raw);
+	ASSERT_TRUE(event_bus_publish(bus, &event));
+	fill_event(&event, 2);
+	ASSERT_TRUE(event_bus_publish(bus, &event));
+	ASSERT_EQ(event_bus_reader_backlog(reader), 2);
+	
+	/* In place */
+	ASSERT_EQ(event_bus_reader_peek(reader, &rec), 0);
+	ASSERT_EQ(rec->event.sequence, 1);
+	ASSERT_EQ(rec->event.nl_seq, 1001);
+	ASSERT_STR_EQ(rec->interface, "eth1");
+	ASSERT_STR_EQ(rec->genl_family, "nl80211");
+	ASSERT_EQ(rec->event.raw_len, sizeof(raw));
+	ASSERT_EQ(memcmp(event_bus_record_raw(rec), raw, sizeof(raw)), 0);
+	ASSERT_TRUE(event_bus_reader_release(reader));
+	
+	/* Copied */
+	ASSERT_EQ(event_bus_reader_read(reader, buf, sizeof(buf)), sizeof(*rec));
+	rec = (const struct event_bus_record *)buf;
+	ASSERT_EQ(rec->event.sequence, 2);
+	ASSERT_NULL(event_bus_record_raw(rec));
+	ASSERT_EQ(event_bus_reader_read(reader, buf, sizeof(buf)), -EAGAIN);
+	ASSERT_EQ(event_bus_reader_lost(reader), 0);
+	
+	event_bus_get_stats(bus, &stats);
+	ASSERT_EQ(stats.published, 2);
+	ASSERT_EQ(stats.truncated, 0);
+	
+	/* Gone once everything is read */
+	event_bus_destroy(bus);
+	ASSERT_EQ(event_bus_reader_peek(reader, &rec), -EPIPE);
+	ASSERT_EQ(event_bus_reader_wait(reader, 0), -EPIPE);
+	event_bus_reader_close(reader);
+	
+	errno = 0;
+	ASSERT_NULL(event_bus_reader_open(TEST_BUS, 0));
+	ASSERT_EQ(errno, ENOENT);
+}
+
+TEST(event_bus_overrun)
+{
+	struct event_bus_options options = { .slots = 8 };
+	const struct event_bus_record *rec;
+	struct event_bus_reader *reader, *late;
+	struct nlmon_event event;
+	struct event_bus *bus;
+	
+	bus = event_bus_create(TEST_BUS, &options);
+	ASSERT_NOT_NULL(bus);
+	reader = event_bus_reader_open(TEST_BUS, 0);
+	ASSERT_NOT_NULL(reader);
+	
+	for (int i = 0; i < 20; i++) {
+		fill_event(&event, i);
+		ASSERT_TRUE(event_bus_publish(bus, &event));
+	}
+	
+	/* 12 overwritten, the last ring's worth remains */
+	ASSERT_EQ(event_bus_reader_backlog(reader), 8);
+	ASSERT_EQ(event_bus_reader_peek(reader, &rec), 0);
+	ASSERT_EQ(rec->event.sequence, 12);
+	ASSERT_EQ(event_bus_reader_lost(reader), 12);
+	
+	/* Overwritten while in use */
+	for (int i = 20; i < 28; i++) {
+		fill_event(&event, i);
+		ASSERT_TRUE(event_bus_publish(bus, &event));
+	}
+	ASSERT_FALSE(event_bus_reader_release(reader));
+	ASSERT_EQ(event_bus_reader_lost(reader), 13);
+	ASSERT_EQ(event_bus_reader_peek(reader, &rec), 0);
+	ASSERT_EQ(rec->event.sequence, 20);
+	ASSERT_TRUE(event_bus_reader_release(reader));
+	
+	/* A reader joining late starts at the oldest record held */
+	late = event_bus_reader_open(TEST_BUS, EVENT_BUS_FROM_OLDEST);
+	ASSERT_NOT_NULL(late);
+	ASSERT_EQ(event_bus_reader_peek(late, &rec), 0);
+	ASSERT_EQ(rec->event.sequence, 20);
+	ASSERT_EQ(event_bus_reader_lost(late), 0);
+	
+	event_bus_reader_close(late);
+	event_bus_reader_close(reader);
+	event_bus_destroy(bus);
+}
+
+TEST(event_bus_truncated_raw)
+{
+	struct event_bus_options options = { .slots = 4, .slot_size = 256, .include_raw = true };
+	const struct event_bus_record *rec;
+	struct event_bus_reader *reader;
+	struct event_bus_stats stats;
+	struct nlmon_event event;
+	struct event_bus *bus;
+	unsigned char raw[1024];
+	
+	bus = event_bus_create(TEST_BUS, &options);
+	ASSERT_NOT_NULL(bus);
+	reader = event_bus_reader_open(TEST_BUS, 0);
+	ASSERT_NOT_NULL(reader);
+	
+	fill_event(&event, 0);
+	memset(raw, 0x5a, sizeof(raw));
+	event.raw_msg = (struct nlmsghdr *)raw;
+	event.raw_msg_len = sizeof(raw);
+	ASSERT_TRUE(event_bus_publish(bus, &event));
+	
+	ASSERT_EQ(event_bus_reader_peek(reader, &rec), 0);
+	ASSERT_EQ(rec->event.raw_len, 256 - sizeof(struct event_bus_slot));
+	ASSERT_TRUE(event_bus_reader_release(reader));
+	event_bus_get_stats(bus, &stats);
+	ASSERT_EQ(stats.truncated, 1);
+	
+	event_bus_reader_close(reader);
+	event_bus_destroy(bus);
+}
+
+/* A reader in another process sleeps until events arrive */
+TEST(event_bus_wait_other_process)
+{
+	struct event_bus_stats stats;
+	struct nlmon_event event;
+	struct event_bus *bus;
+	int ready[2], status;
+	pid_t pid;
+	char c;
+	
+	bus = event_bus_create(TEST_BUS, NULL);
+	ASSERT_NOT_NULL(bus);
+	ASSERT_EQ(pipe(ready), 0);
+	
+	pid = fork();
+	ASSERT_TRUE(pid >= 0);
+	if (pid == 0) {
+		struct event_bus_reader *reader = event_bus_reader_open(TEST_BUS, 0);
+		unsigned char buf[1024];
+		uint64_t next = 0;
+		int ret;
+	
+		if (!reader)
+			_exit(2);
+		if (write(ready[1], "r", 1) != 1)
+			_exit(2);
+	
+		/* Read until the publisher goes, in order and without loss */
+		for (;;) {
+			ret = event_bus_reader_read(reader, buf, sizeof(buf));
+			if (ret == -EAGAIN) {
+				ret = event_bus_reader_wait(reader, 5000);
+				if (ret == -ETIMEDOUT)
+					_exit(3);
+				continue;
+			}
+			if (ret < 0)
+				break;
+			if (((struct event_bus_record *)buf)->event.sequence != next++)
+				_exit(4);
+		}
+		_exit(ret == -EPIPE && next == 100 && event_bus_reader_lost(reader) == 0 ? 0 : 5);
+	}
+	
+	ASSERT_EQ(read(ready[0], &c, 1), 1);
+	close(ready[0]);
+	close(ready[1]);
+	
+	/* Give the reader time to fall asleep now and then */
+	for (int i = 0; i < 100; i++) {
+		fill_event(&event, i);
+		ASSERT_TRUE(event_bus_publish(bus, &event));
+		if (i % 10 == 9)
+			usleep(20000);
+	}
+	usleep(20000);
+	
+	event_bus_get_stats(bus, &stats);
+	ASSERT_TRUE(stats.wakeups > 0);
+	event_bus_destroy(bus);
+	
+	ASSERT_EQ(waitpid(pid, &status, 0), pid);
+	ASSERT_TRUE(WIFEXITED(status));
+	ASSERT_EQ(WEXITSTATUS(status), 0);
+}
+
+TEST(event_bus_not_a_bus)
+{
+	int fd;
+	
+	fd = shm_open(TEST_BUS, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	ASSERT_TRUE(fd >= 0);
+	ASSERT_EQ(ftruncate(fd, 4096), 0);
+	close(fd);
+	
+	errno = 0;
+	ASSERT_NULL(event_bus_reader_open(TEST_BUS, 0));
+	ASSERT_EQ(errno, EPROTO);
+	shm_unlink(TEST_BUS);
+	
+	errno = 0;
+	ASSERT_NULL(event_bus_create("no-slash", NULL));
+	ASSERT_EQ(errno, EINVAL);
+}
+
+TEST_SUITE_BEGIN("Event Bus")
+	RUN_TEST(event_bus_roundtrip);
+	RUN_TEST(event_bus_overrun);
+	RUN_TEST(event_bus_truncated_raw);
+	RUN_TEST(event_bus_wait_other_process);
+	RUN_TEST(event_bus_not_a_bus);
+TEST_SUITE_END()
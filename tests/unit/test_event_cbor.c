@@ -0,0 +1,143 @@
+/* test_event_cbor.c - Unit tests for the binary event encoding */
+
+#include "test_framework.h"
+#include "event_cbor.h"
+#include "event_processor.h"
+#include <stdio.h>
+#include <string.h>
+
+static bool bytes_eq(const struct json_buf *buf, const char *expected, size_t len)
+{
+	return buf->len == len && memcmp(buf->data, expected, len) == 0;
+}
+
+TEST(cbor_event_layout)
+{
+	static const char expected[] =
+		"\x83\x01\x00\x65" "wlan0"            /* [1, 0, "wlan0"] */
+		"\x83\x02\x00\x67" "nl80211"          /* [2, 0, "nl80211"] */
+		"\x88\x00"                            /* [0, */
+		"\x1b\x00\x00\x00\x01\x00\x00\x00\x00" /* 2^32, */
+		"\x18\x64\x03\x19\x01\x2c"            /* 100, 3, 300, */
+		"\x00\x10\x00";                       /* 0, 16, 0] */
+	struct event_cbor_dict *dict = event_cbor_dict_create();
+	struct event_cbor_record record;
+	struct nlmon_event event;
+	struct json_buf buf;
+	
+	ASSERT_NOT_NULL(dict);
+	ASSERT_TRUE(json_buf_init(&buf, 0));
+	
+	memset(&event, 0, sizeof(event));
+	event.timestamp = 1ULL << 32;
+	event.sequence = 100;
+	event.event_type = 3;
+	event.message_type = 300;
+	event.netlink.protocol = 16;
+	snprintf(event.interface, sizeof(event.interface), "wlan0");
+	snprintf(event.netlink.genl_family_name, sizeof(event.netlink.genl_family_name), "nl80211");
+	event_cbor_record_init(&record, &event);
+	
+	/* Definitions go first when they share the buffer */
+	event_cbor_append(&buf, &buf, dict, &record);
+	ASSERT_TRUE(bytes_eq(&buf, expected, sizeof(expected) - 1));
+	
+	/* Known names are an index from then on */
+	json_buf_reset(&buf);
+	event_cbor_append(&buf, &buf, dict, &record);
+	ASSERT_TRUE(bytes_eq(&buf, expected + 20, sizeof(expected) - 1 - 20));
+	
+	/* Empty names and unknown protocols are null */
+	event.interface[0] = '\0';
+	event.netlink.genl_family_name[0] = '\0';
+	event.netlink.protocol = -1;
+	event_cbor_record_init(&record, &event);
+	json_buf_reset(&buf);
+	event_cbor_append(&buf, &buf, dict, &record);
+	ASSERT_EQ((unsigned char)buf.data[buf.len - 3], 0xf6);
+	ASSERT_EQ((unsigned char)buf.data[buf.len - 2], 0xf6);
+	ASSERT_EQ((unsigned char)buf.data[buf.len - 1], 0xf6);
+	
+	json_buf_free(&buf);
+	event_cbor_dict_destroy(dict);
+}
+
+TEST(cbor_dictionary)
+{
+	struct event_cbor_dict *dict = event_cbor_dict_create();
+	struct event_cbor_record record = { .protocol = 0 };
+	struct json_buf out, defs;
+	char name[64];
+	
+	ASSERT_NOT_NULL(dict);
+	ASSERT_TRUE(json_buf_init(&out, 0));
+	ASSERT_TRUE(json_buf_init(&defs, 0));
+	
+	/* Separate buffers keep definitions out of the event */
+	record.interface = "eth0";
+	record.interface_len = 4;
+	event_cbor_append(&out, &defs, dict, &record);
+	ASSERT_TRUE(bytes_eq(&defs, "\x83\x01\x00\x64" "eth0", 8));
+	ASSERT_EQ(out.len, 9);
+	
+	/* Names past the limit are sent as text without a definition */
+	for (int i = 1; i < EVENT_CBOR_DICT_MAX; i++) {
+		snprintf(name, sizeof(name), "veth%d", i);
+		record.interface = name;
+		record.interface_len = strlen(name);
+		event_cbor_append(&out, &defs, dict, &record);
+	}
+	json_buf_reset(&out);
+	json_buf_reset(&defs);
+	record.interface = "dummy0";
+	record.interface_len = 6;
+	event_cbor_append(&out, &defs, dict, &record);
+	ASSERT_EQ(defs.len, 0);
+	ASSERT_TRUE(memcmp(out.data + 6, "\x66" "dummy0", 7) == 0);
+	
+	/* So are names too long to keep */
+	memset(name, 'x', EVENT_CBOR_NAME_MAX);
+	event_cbor_dict_destroy(dict);
+	dict = event_cbor_dict_create();
+	json_buf_reset(&out);
+	record.interface = name;
+	record.interface_len = EVENT_CBOR_NAME_MAX;
+	event_cbor_append(&out, &defs, dict, &record);
+	ASSERT_EQ(defs.len, 0);
+	
+	/* A dump defines everything known */
+	record.interface = "eth0";
+	record.interface_len = 4;
+	record.family = "devlink";
+	record.family_len = 7;
+	event_cbor_append(&out, &defs, dict, &record);
+	json_buf_reset(&out);
+	event_cbor_append_dict(&out, dict);
+	ASSERT_TRUE(bytes_eq(&out, "\x83\x01\x00\x64" "eth0" "\x83\x02\x00\x67" "devlink", 19));
+	
+	json_buf_free(&out);
+	json_buf_free(&defs);
+	event_cbor_dict_destroy(dict);
+}
+
+TEST(cbor_listing_end)
+{
+	struct json_buf buf;
+	
+	ASSERT_TRUE(json_buf_init(&buf, 0));
+	
+	event_cbor_append_end(&buf, "12.34", 100);
+	ASSERT_TRUE(bytes_eq(&buf, "\x83\x03\x65" "12.34" "\x18\x64", 10));
+	
+	json_buf_reset(&buf);
+	event_cbor_append_end(&buf, NULL, 0);
+	ASSERT_TRUE(bytes_eq(&buf, "\x83\x03\xf6\x00", 4));
+	
+	json_buf_free(&buf);
+}
+
+TEST_SUITE_BEGIN("Event CBOR")
+	RUN_TEST(cbor_event_layout);
+	RUN_TEST(cbor_dictionary);
+	RUN_TEST(cbor_listing_end);
+TEST_SUITE_END()
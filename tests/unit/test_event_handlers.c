@@ -0,0 +1,266 @@
+/* test_event_handlers.c - Unit tests for event processor handler registration */
+
+#include "test_framework.h"
+#include "event_processor.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_EVENTS 2000
+
+static _Atomic int in_flight;
+static _Atomic int max_in_flight;
+static _Atomic uint64_t counted;
+static _Atomic bool handler_entered;
+static _Atomic bool handler_done;
+
+/* Events seen by record_event */
+#define SHARED_SUBMITTERS 4
+#define SHARED_EVENTS 500
+static struct nlmon_event *seen_event[SHARED_SUBMITTERS * SHARED_EVENTS + 1];
+static uint64_t seen_sequence[SHARED_SUBMITTERS * SHARED_EVENTS + 1];
+static _Atomic int seen;
+
+struct submitter {
+	struct event_processor *ep;
+	struct nlmon_event *event;
+	int lane;
+};
+
+static struct event_processor *create_processor(size_t workers)
+{
+	struct event_processor_config config;
+	
+	memset(&config, 0, sizeof(config));
+	config.ring_buffer_size = 4096;
+	config.thread_pool_size = workers;
+	config.overload_policy = EVENT_OVERLOAD_BLOCK;
+	config.overload_timeout_ms = 1000;
+	return event_processor_create(&config);
+}
+
+static void submit_events(struct event_processor *ep, int count)
+{
+	struct nlmon_event event;
+	
+	for (int i = 0; i < count; i++) {
+		memset(&event, 0, sizeof(event));
+		event.event_type = 1;
+		event.sequence = i;
+		event_processor_submit(ep, &event);
+	}
+}
+
+static void count_event(struct nlmon_event *event, void *ctx)
+{
+	atomic_fetch_add(&counted, 1);
+}
+
+/* Stays in the handler long enough for other workers to join */
+static void slow_event(struct nlmon_event *event, void *ctx)
+{
+	int now = atomic_fetch_add(&in_flight, 1) + 1;
+	int max = atomic_load(&max_in_flight);
+	
+	while (now > max && !atomic_compare_exchange_weak(&max_in_flight, &max, now))
+		;
+	usleep(2000);
+	atomic_fetch_sub(&in_flight, 1);
+}
+
+static void blocking_event(struct nlmon_event *event, void *ctx)
+{
+	if (atomic_exchange(&handler_entered, true))
+		return;
+	usleep(50000);
+	atomic_store(&handler_done, true);
+}
+
+static void record_event(struct nlmon_event *event, void *ctx)
+{
+	int i = atomic_fetch_add(&seen, 1);
+	
+	if (i < (int)(sizeof(seen_event) / sizeof(seen_event[0]))) {
+		seen_event[i] = event;
+		seen_sequence[i] = event->sequence;
+	}
+}
+
+static void *submit_shared(void *arg)
+{
+	struct submitter *s = arg;
+	
+	for (int i = 0; i < SHARED_EVENTS; i++)
+		event_processor_submit_lane(s->ep, s->lane, s->event);
+	return NULL;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	
+	return (x > y) - (x < y);
+}
+
+TEST(handlers_run_on_workers_in_parallel)
+{
+	struct event_processor *ep = create_processor(4);
+	
+	struct nlmon_event event;
+	int lanes[4];
+	
+	ASSERT_NOT_NULL(ep);
+	atomic_store(&max_in_flight, 0);
+	ASSERT_TRUE(event_processor_register_handler(ep, slow_event, NULL) >= 0);
+	
+	/* A lane is drained by one worker at a time, so spread the events */
+	for (int l = 0; l < 4; l++) {
+		lanes[l] = event_processor_add_lane(ep, 0);
+		ASSERT_TRUE(lanes[l] > 0);
+	}
+	for (int i = 0; i < 200; i++) {
+		memset(&event, 0, sizeof(event));
+		event.event_type = 1;
+		event_processor_submit_lane(ep, lanes[i % 4], &event);
+	}
+	event_processor_wait(ep);
+	
+	ASSERT_TRUE(atomic_load(&max_in_flight) > 1);
+	event_processor_destroy(ep, true);
+}
+
+TEST(unregister_waits_for_running_handler)
+{
+	struct event_processor *ep = create_processor(2);
+	int id;
+	
+	ASSERT_NOT_NULL(ep);
+	atomic_store(&handler_entered, false);
+	atomic_store(&handler_done, false);
+	id = event_processor_register_handler(ep, blocking_event, NULL);
+	ASSERT_TRUE(id >= 0);
+	
+	submit_events(ep, 1);
+	for (int wait = 0; wait < 500 && !atomic_load(&handler_entered); wait++)
+		usleep(1000);
+	ASSERT_TRUE(atomic_load(&handler_entered));
+	
+	/* The handler is still sleeping, unregistering must outlast it */
+	event_processor_unregister_handler(ep, id);
+	ASSERT_TRUE(atomic_load(&handler_done));
+	
+	event_processor_wait(ep);
+	event_processor_destroy(ep, true);
+}
+
+TEST(registration_churn_keeps_other_handlers)
+{
+	struct event_processor *ep = create_processor(4);
+	
+	ASSERT_NOT_NULL(ep);
+	atomic_store(&counted, 0);
+	ASSERT_TRUE(event_processor_register_handler(ep, count_event, NULL) >= 0);
+	
+	/* Handlers come and go while events are dispatched */
+	for (int i = 0; i < TEST_EVENTS / 100; i++) {
+		int id = event_processor_register_handler(ep, slow_event, NULL);
+		
+		ASSERT_TRUE(id >= 0);
+		submit_events(ep, 100);
+		event_processor_unregister_handler(ep, id);
+	}
+	event_processor_wait(ep);
+	
+	ASSERT_EQ(atomic_load(&counted), TEST_EVENTS);
+	event_processor_destroy(ep, true);
+}
+
+TEST(unregister_unknown_and_last_handler)
+{
+	struct event_processor *ep = create_processor(2);
+	int id;
+	
+	ASSERT_NOT_NULL(ep);
+	atomic_store(&counted, 0);
+	id = event_processor_register_handler(ep, count_event, NULL);
+	ASSERT_TRUE(id >= 0);
+	
+	event_processor_unregister_handler(ep, id + 100);
+	submit_events(ep, 10);
+	event_processor_wait(ep);
+	ASSERT_EQ(atomic_load(&counted), 10);
+	
+	/* Events without handlers are still processed */
+	event_processor_unregister_handler(ep, id);
+	submit_events(ep, 10);
+	event_processor_wait(ep);
+	ASSERT_EQ(atomic_load(&counted), 10);
+	
+	event_processor_destroy(ep, true);
+}
+
+TEST(shared_events_are_not_modified)
+{
+	struct event_processor *ep = create_processor(2);
+	struct submitter submitters[SHARED_SUBMITTERS];
+	pthread_t threads[SHARED_SUBMITTERS];
+	struct nlmon_event *published, *ref, *owned;
+	
+	ASSERT_NOT_NULL(ep);
+	atomic_store(&seen, 0);
+	ASSERT_TRUE(event_processor_register_handler(ep, record_event, NULL) >= 0);
+	
+	/* An event already published elsewhere, submitted concurrently */
+	published = nlmon_event_alloc(0);
+	ASSERT_NOT_NULL(published);
+	published->event_type = 1;
+	published->sequence = 777;
+	ref = nlmon_event_share(published);
+	ASSERT_TRUE(ref == published);
+	
+	for (int t = 0; t < SHARED_SUBMITTERS; t++) {
+		submitters[t].ep = ep;
+		submitters[t].event = published;
+		submitters[t].lane = event_processor_add_lane(ep, 0);
+		ASSERT_TRUE(submitters[t].lane > 0);
+		ASSERT_EQ(pthread_create(&threads[t], NULL, submit_shared, &submitters[t]), 0);
+	}
+	for (int t = 0; t < SHARED_SUBMITTERS; t++)
+		pthread_join(threads[t], NULL);
+	event_processor_wait(ep);
+	
+	/* The holders' event is untouched, every queued copy got its own number */
+	ASSERT_EQ(published->sequence, 777);
+	ASSERT_EQ(atomic_load(&seen), SHARED_SUBMITTERS * SHARED_EVENTS);
+	for (int i = 0; i < SHARED_SUBMITTERS * SHARED_EVENTS; i++)
+		ASSERT_TRUE(seen_event[i] != published);
+	qsort(seen_sequence, SHARED_SUBMITTERS * SHARED_EVENTS, sizeof(seen_sequence[0]),
+	      compare_u64);
+	for (int i = 1; i < SHARED_SUBMITTERS * SHARED_EVENTS; i++)
+		ASSERT_TRUE(seen_sequence[i] != seen_sequence[i - 1]);
+	nlmon_event_put(ref);
+	nlmon_event_put(published);
+	
+	/* An event only the submitter holds is queued by reference */
+	atomic_store(&seen, 0);
+	owned = nlmon_event_alloc(0);
+	ASSERT_NOT_NULL(owned);
+	owned->event_type = 1;
+	ASSERT_TRUE(event_processor_submit(ep, owned));
+	event_processor_wait(ep);
+	ASSERT_EQ(atomic_load(&seen), 1);
+	ASSERT_TRUE(seen_event[0] == owned);
+	nlmon_event_put(owned);
+	
+	event_processor_destroy(ep, true);
+}
+
+TEST_SUITE_BEGIN("Event Handlers")
+	RUN_TEST(handlers_run_on_workers_in_parallel);
+	RUN_TEST(unregister_waits_for_running_handler);
+	RUN_TEST(registration_churn_keeps_other_handlers);
+	RUN_TEST(unregister_unknown_and_last_handler);
+	RUN_TEST(shared_events_are_not_modified);
+TEST_SUITE_END()
@@ -0,0 +1,253 @@
+/* test_event_hooks.c - Unit tests for hook queueing and dispatch */
+
+#include "test_framework.h"
+#include "event_hooks.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_SEQ_FILE "/tmp/test_unit_event_hooks.seq"
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void hook_init(struct hook_config *config, const char *name, const char *script)
+{
+	memset(config, 0, sizeof(*config));
+	snprintf(config->name, sizeof(config->name), "%s", name);
+	snprintf(config->script, sizeof(config->script), "%s", script);
+	config->enabled = true;
+}
+
+static void fire(struct hook_manager *hm, int count)
+{
+	struct nlmon_event event;
+	
+	for (int i = 1; i <= count; i++) {
+		memset(&event, 0, sizeof(event));
+		event.event_type = 1;
+		event.sequence = i;
+		hook_manager_execute(hm, &event);
+	}
+}
+
+TEST(execute_does_not_wait_for_slow_hook)
+{
+	struct hook_manager *hm = hook_manager_create(0, 0);
+	struct hook_config config;
+	struct hook_stats stats;
+	uint64_t start;
+	int id;
+	
+	ASSERT_NOT_NULL(hm);
+	hook_init(&config, "slow", "sleep 0.1");
+	id = hook_manager_register(hm, &config);
+	ASSERT_TRUE(id >= 0);
+	
+	start = now_ms();
+	fire(hm, 5);
+	ASSERT_TRUE(now_ms() - start < 100);
+	
+	/* Synchronous hooks run one after another, all five of them */
+	hook_manager_wait(hm);
+	ASSERT_TRUE(now_ms() - start >= 500);
+	ASSERT_TRUE(hook_manager_get_stats(hm, id, &stats));
+	ASSERT_EQ(stats.executions, 5);
+	ASSERT_EQ(stats.successes, 5);
+	ASSERT_EQ(stats.queued, 0);
+	ASSERT_EQ(stats.dropped, 0);
+	
+	hook_manager_destroy(hm, true);
+}
+
+TEST(full_queue_drops_new_events)
+{
+	struct hook_manager *hm = hook_manager_create(0, 0);
+	struct hook_config config;
+	struct hook_stats stats;
+	int id;
+	
+	ASSERT_NOT_NULL(hm);
+	hook_init(&config, "drop", "sleep 0.1");
+	config.queue_size = 2;
+	id = hook_manager_register(hm, &config);
+	ASSERT_TRUE(id >= 0);
+	
+	fire(hm, 10);
+	hook_manager_wait(hm);
+	
+	ASSERT_TRUE(hook_manager_get_stats(hm, id, &stats));
+	ASSERT_TRUE(stats.dropped >= 7);
+	ASSERT_EQ(stats.executions + stats.dropped, 10);
+	
+	hook_manager_destroy(hm, true);
+}
+
+TEST(coalesce_keeps_the_latest_event)
+{
+	struct hook_manager *hm = hook_manager_create(0, 0);
+	struct hook_config config;
+	struct hook_stats stats;
+	char line[32], last[32] = "";
+	FILE *fp;
+	int id;
+	
+	ASSERT_NOT_NULL(hm);
+	unlink(TEST_SEQ_FILE);
+	hook_init(&config, "coalesce", "echo $NLMON_SEQUENCE >> " TEST_SEQ_FILE "; sleep 0.1");
+	config.queue_size = 1;
+	config.overflow = HOOK_OVERFLOW_COALESCE;
+	id = hook_manager_register(hm, &config);
+	ASSERT_TRUE(id >= 0);
+	
+	fire(hm, 10);
+	hook_manager_wait(hm);
+	
+	ASSERT_TRUE(hook_manager_get_stats(hm, id, &stats));
+	ASSERT_TRUE(stats.coalesced > 0);
+	ASSERT_EQ(stats.dropped, 0);
+	ASSERT_EQ(stats.executions + stats.coalesced, 10);
+	
+	fp = fopen(TEST_SEQ_FILE, "r");
+	ASSERT_NOT_NULL(fp);
+	while (fgets(line, sizeof(line), fp))
+		strcpy(last, line);
+	fclose(fp);
+	unlink(TEST_SEQ_FILE);
+	ASSERT_STR_EQ(last, "10\n");
+	
+	hook_manager_destroy(hm, true);
+}
+
+TEST(sample_sheds_from_half_full)
+{
+	struct hook_manager *hm = hook_manager_create(0, 0);
+	struct hook_config config;
+	struct hook_stats stats;
+	int id;
+	
+	ASSERT_NOT_NULL(hm);
+	hook_init(&config, "sample", "sleep 0.05");
+	config.queue_size = 8;
+	config.overflow = HOOK_OVERFLOW_SAMPLE;
+	config.sample_rate = 4;
+	id = hook_manager_register(hm, &config);
+	ASSERT_TRUE(id >= 0);
+	
+	fire(hm, 40);
+	hook_manager_wait(hm);
+	
+	ASSERT_TRUE(hook_manager_get_stats(hm, id, &stats));
+	ASSERT_TRUE(stats.sampled > 0);
+	ASSERT_EQ(stats.coalesced, 0);
+	ASSERT_EQ(stats.executions + stats.sampled + stats.dropped, 40);
+	
+	hook_manager_destroy(hm, true);
+}
+
+TEST(batches_run_when_full_or_flushed)
+{
+	struct hook_manager *hm = hook_manager_create(0, 0);
+	struct hook_config config;
+	struct hook_stats stats;
+	int id;
+	
+	ASSERT_NOT_NULL(hm);
+	hook_init(&config, "batch", "test \"$(wc -l)\" = \"$NLMON_BATCH_COUNT\"");
+	config.batch_count = 4;
+	id = hook_manager_register(hm, &config);
+	ASSERT_TRUE(id >= 0);
+	
+	fire(hm, 10);
+	hook_manager_wait(hm);
+	ASSERT_TRUE(hook_manager_get_stats(hm, id, &stats));
+	ASSERT_EQ(stats.executions, 2);
+	
+	/* The two events left run on a flush */
+	hook_manager_flush(hm);
+	hook_manager_wait(hm);
+	ASSERT_TRUE(hook_manager_get_stats(hm, id, &stats));
+	ASSERT_EQ(stats.executions, 3);
+	ASSERT_EQ(stats.successes, 3);
+	
+	hook_manager_destroy(hm, true);
+}
+
+TEST(registration_not_blocked_by_running_hook)
+{
+	struct hook_manager *hm = hook_manager_create(0, 1);
+	struct hook_config config;
+	uint64_t start;
+	int id;
+	
+	ASSERT_NOT_NULL(hm);
+	hook_init(&config, "busy", "sleep 0.3");
+	ASSERT_TRUE(hook_manager_register(hm, &config) >= 0);
+	fire(hm, 3);
+	
+	/* The manager's only slot is taken, registering must not wait on it */
+	start = now_ms();
+	hook_init(&config, "other", "true");
+	id = hook_manager_register(hm, &config);
+	ASSERT_TRUE(id >= 0);
+	ASSERT_TRUE(hook_manager_disable(hm, id));
+	ASSERT_TRUE(hook_manager_unregister(hm, id));
+	ASSERT_TRUE(now_ms() - start < 100);
+	
+	hook_manager_destroy(hm, false);
+}
+
+static _Atomic bool firing;
+
+static void *fire_thread(void *arg)
+{
+	while (atomic_load(&firing))
+		fire(arg, 100);
+	return NULL;
+}
+
+TEST(register_unregister_while_matching)
+{
+	struct hook_manager *hm = hook_manager_create(8, 0);
+	struct hook_config config;
+	pthread_t threads[2];
+	
+	ASSERT_NOT_NULL(hm);
+	atomic_store(&firing, true);
+	for (int t = 0; t < 2; t++)
+		ASSERT_EQ(pthread_create(&threads[t], NULL, fire_thread, hm), 0);
+	
+	/* Conditions are evaluated on hooks that come and go */
+	for (int i = 0; i < 200; i++) {
+		int id;
+		
+		hook_init(&config, "churn", "true");
+		snprintf(config.condition, sizeof(config.condition), "event_type == %d", 1000 + i);
+		id = hook_manager_register(hm, &config);
+		ASSERT_TRUE(id >= 0);
+		ASSERT_TRUE(hook_manager_unregister(hm, id));
+	}
+	
+	atomic_store(&firing, false);
+	for (int t = 0; t < 2; t++)
+		pthread_join(threads[t], NULL);
+	hook_manager_destroy(hm, true);
+}
+
+TEST_SUITE_BEGIN("Event Hooks")
+	RUN_TEST(execute_does_not_wait_for_slow_hook);
+	RUN_TEST(full_queue_drops_new_events);
+	RUN_TEST(coalesce_keeps_the_latest_event);
+	RUN_TEST(sample_sheds_from_half_full);
+	RUN_TEST(batches_run_when_full_or_flushed);
+	RUN_TEST(registration_not_blocked_by_running_hook);
+	RUN_TEST(register_unregister_while_matching);
+TEST_SUITE_END()
@@ -0,0 +1,229 @@
+/* test_event_sampler.c - Unit tests for per event type sampling */
+
+#include "test_framework.h"
+#include "event_sampler.h"
+#include "event_processor.h"
+#include <linux/netlink.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MS 1000000ULL
+
+/* What the sampler handed on */
+struct sampled {
+	uint64_t count;
+	uint64_t weight[4];             /* By event type */
+	uint64_t last_timestamp;
+	bool ordered;
+};
+
+static void collect(struct nlmon_event *event, uint32_t weight, void *ctx)
+{
+	struct sampled *s = ctx;
+	
+	s->count++;
+	s->weight[event->event_type & 3] += weight;
+	if (event->timestamp < s->last_timestamp)
+		s->ordered = false;
+	s->last_timestamp = event->timestamp;
+}
+
+static uint32_t offer(struct event_sampler *sampler, uint32_t type, uint64_t now_ns,
+                      struct sampled *s)
+{
+	struct nlmon_event event;
+	uint32_t weight;
+	
+	memset(&event, 0, sizeof(event));
+	event.event_type = type;
+	event.timestamp = now_ns;
+	event.sequence = now_ns;
+	weight = event_sampler_offer(sampler, &event, now_ns, collect, s);
+	if (weight) {
+		s->count++;
+		s->weight[type & 3] += weight;
+	}
+	return weight;
+}
+
+TEST(event_sampler_fixed)
+{
+	struct event_sampler_rule rule = { .event_type = 1, .mode = EVENT_SAMPLER_FIXED, .rate = 10 };
+	struct event_sampler_config config = { .rules = &rule, .num_rules = 1 };
+	struct event_sampler *sampler = event_sampler_create(&config);
+	struct event_sampler_stats stats;
+	struct sampled s = { .ordered = true };
+	
+	ASSERT_NOT_NULL(sampler);
+	ASSERT_TRUE(event_sampler_config_active(&config));
+	ASSERT_FALSE(event_sampler_holds(sampler));
+	
+	/* Type 1 keeps 1 in 10, type 2 has no rule and keeps everything */
+	for (uint64_t i = 0; i < 1000; i++) {
+		offer(sampler, 1, 1 + i * MS, &s);
+		ASSERT_EQ(offer(sampler, 2, 1 + i * MS, &s), 1);
+	}
+	ASSERT_EQ(s.weight[1], 1000);
+	ASSERT_EQ(s.weight[2], 1000);
+	ASSERT_EQ(s.count, 1100);
+	
+	event_sampler_get_stats(sampler, &stats);
+	ASSERT_EQ(stats.seen, 2000);
+	ASSERT_EQ(stats.kept, 1100);
+	ASSERT_EQ(stats.weight, 2000);
+	ASSERT_EQ(stats.types, 2);
+	
+	event_sampler_destroy(sampler);
+}
+
+TEST(event_sampler_reservoir)
+{
+	struct event_sampler_config config = {
+		.fallback = { .mode = EVENT_SAMPLER_RESERVOIR, .rate = 5 },
+		.interval_ms = 100,
+	};
+	struct event_sampler *sampler = event_sampler_create(&config);
+	struct event_sampler_stats stats;
+	struct sampled s = { .ordered = true };
+	
+	ASSERT_NOT_NULL(sampler);
+	ASSERT_TRUE(event_sampler_holds(sampler));
+	
+	/* 50 events of each of two types per 100 ms interval, all held */
+	for (uint64_t i = 0; i < 100; i++) {
+		ASSERT_EQ(offer(sampler, 1, 1 + i * MS, &s), 0);
+		ASSERT_EQ(offer(sampler, 2, 1 + i * MS, &s), 0);
+	}
+	ASSERT_EQ(s.count, 0);
+	event_sampler_get_stats(sampler, &stats);
+	ASSERT_EQ(stats.held, 10);
+	
+	/* The first event of the next interval hands the reservoirs on */
+	ASSERT_EQ(event_sampler_tick(sampler, 1 + 99 * MS, collect, &s), 0);
+	ASSERT_EQ(event_sampler_tick(sampler, 1 + 100 * MS, collect, &s), 10);
+	ASSERT_EQ(s.count, 10);
+	ASSERT_TRUE(s.ordered);
+	ASSERT_TRUE(s.weight[1] >= 95 && s.weight[1] <= 105);
+	ASSERT_TRUE(s.weight[2] >= 95 && s.weight[2] <= 105);
+	
+	/* A drain closes the interval early, weights of its part */
+	memset(&s, 0, sizeof(s));
+	s.ordered = true;
+	offer(sampler, 1, 1 + 110 * MS, &s);
+	offer(sampler, 1, 1 + 120 * MS, &s);
+	ASSERT_EQ(event_sampler_drain(sampler, collect, &s), 2);
+	ASSERT_EQ(s.weight[1], 2);
+	ASSERT_TRUE(s.ordered);
+	
+	event_sampler_get_stats(sampler, &stats);
+	ASSERT_EQ(stats.held, 0);
+	ASSERT_EQ(stats.seen, 202);
+	ASSERT_EQ(stats.kept, 12);
+	
+	/* Held events are released with the sampler */
+	offer(sampler, 3, 1 + 130 * MS, &s);
+	event_sampler_destroy(sampler);
+}
+
+TEST(event_sampler_adaptive)
+{
+	struct event_sampler_rule rule = { .event_type = 1, .mode = EVENT_SAMPLER_ADAPTIVE, .rate = 100 };
+	struct event_sampler_config config = { .rules = &rule, .num_rules = 1 };
+	struct event_sampler *sampler = event_sampler_create(&config);
+	struct sampled s = { .ordered = true };
+	uint64_t kept_last = 0, weight_total;
+	
+	ASSERT_NOT_NULL(sampler);
+	
+	/* 10000 events per second for 10 seconds, about 100 kept per second */
+	for (uint64_t i = 0; i < 100000; i++) {
+		uint64_t before = s.count;
+	
+		offer(sampler, 1, 1 + i * 100000, &s);
+		if (i >= 90000)
+			kept_last += s.count - before;
+	}
+	weight_total = s.weight[1];
+	
+	/* The last second settles near the target */
+	ASSERT_TRUE(kept_last >= 50 && kept_last <= 200);
+	
+	/* The weights estimate what was seen */
+	ASSERT_TRUE(weight_total >= 90000 && weight_total <= 110000);
+	
+	event_sampler_destroy(sampler);
+}
+
+TEST(event_sampler_genl_cmd)
+{
+	struct event_sampler_rule rules[] = {
+		{ .event_type = 1, .mode = EVENT_SAMPLER_FIXED, .rate = 4 },
+		{ .event_type = 1, .by_cmd = true, .genl_cmd = 7, .mode = EVENT_SAMPLER_ALL },
+	};
+	struct event_sampler_config config = { .rules = rules, .num_rules = 2 };
+	struct event_sampler *sampler = event_sampler_create(&config);
+	struct nlmon_event event;
+	uint64_t cmd7 = 0, cmd8 = 0;
+	
+	ASSERT_NOT_NULL(sampler);
+	
+	memset(&event, 0, sizeof(event));
+	event.event_type = 1;
+	event.netlink.protocol = NETLINK_GENERIC;
+	for (uint64_t i = 0; i < 100; i++) {
+		event.netlink.genl_cmd = 7;
+		cmd7 += event_sampler_offer(sampler, &event, 1 + i, NULL, NULL) ? 1 : 0;
+		event.netlink.genl_cmd = 8;
+		cmd8 += event_sampler_offer(sampler, &event, 1 + i, NULL, NULL) ? 1 : 0;
+	}
+	ASSERT_EQ(cmd7, 100);
+	ASSERT_EQ(cmd8, 25);
+	
+	event_sampler_destroy(sampler);
+}
+
+TEST(event_sampler_overflow)
+{
+	struct event_sampler_config config = {
+		.fallback = { .mode = EVENT_SAMPLER_FIXED, .rate = 2 },
+	};
+	struct event_sampler *sampler = event_sampler_create(&config);
+	struct event_sampler_stats stats;
+	struct sampled s = { .ordered = true };
+	
+	ASSERT_NOT_NULL(sampler);
+	
+	/* Types beyond the table share one state, and still sample */
+	for (uint32_t type = 0; type < EVENT_SAMPLER_MAX_TYPES + 44; type++) {
+		offer(sampler, type, 1, &s);
+		offer(sampler, type, 2, &s);
+	}
+	
+	event_sampler_get_stats(sampler, &stats);
+	ASSERT_EQ(stats.types, EVENT_SAMPLER_MAX_TYPES);
+	ASSERT_EQ(stats.overflow, 88);
+	ASSERT_EQ(stats.weight, 2 * (EVENT_SAMPLER_MAX_TYPES + 44));
+	
+	event_sampler_destroy(sampler);
+}
+
+TEST(event_sampler_bad_config)
+{
+	struct event_sampler_rule rule = { .event_type = 1, .mode = EVENT_SAMPLER_FIXED };
+	struct event_sampler_config config = { .rules = &rule, .num_rules = 1 };
+	struct event_sampler_config all = { 0 };
+	
+	ASSERT_NULL(event_sampler_create(&config));
+	ASSERT_NULL(event_sampler_create(NULL));
+	ASSERT_FALSE(event_sampler_config_active(&all));
+	ASSERT_FALSE(event_sampler_config_active(NULL));
+}
+
+TEST_SUITE_BEGIN("Event Sampler")
+	RUN_TEST(event_sampler_fixed);
+	RUN_TEST(event_sampler_reservoir);
+	RUN_TEST(event_sampler_adaptive);
+	RUN_TEST(event_sampler_genl_cmd);
+	RUN_TEST(event_sampler_overflow);
+	RUN_TEST(event_sampler_bad_config);
+TEST_SUITE_END()
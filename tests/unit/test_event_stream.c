@@ -0,0 +1,338 @@
+/* test_event_stream.c - Unit tests for event streaming to a collector */
+
+#include "test_framework.h"
+#include "event_stream.h"
+#include "event_processor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <zlib.h>
+
+#define TEST_SPILL "/tmp/test_unit_event_stream.spill"
+
+struct received {
+	uint64_t next;                  /* Sequence expected next */
+	uint64_t out_of_order;
+	char node[EVENT_STREAM_NODE_SIZE];
+	char interface[BINEXP_NAME_SIZE];
+	uint32_t raw_len;
+};
+
+static void fill_event(struct nlmon_event *event, int i)
+{
+	memset(event, 0, sizeof(*event));
+	event->timestamp = 1700000000000000ULL + i;
+	event->sequence = i;
+	event->event_type = i % 7;
+	event->message_type = 16 + i % 3;
+	snprintf(event->interface, sizeof(event->interface), "eth%d", i % 4);
+	event->netlink.protocol = NETLINK_ROUTE;
+	event->netlink.msg_type = 16 + i % 3;
+	event->netlink.seq = 1000 + i;
+	event->netlink.pid = 42;
+}
+
+static void on_event(const char *node, const struct event_bus_record *rec, void *ctx)
+{
+	struct received *received = ctx;
+	
+	if (rec->event.sequence != received->next)
+		received->out_of_order++;
+	received->next = rec->event.sequence + 1;
+	snprintf(received->node, sizeof(received->node), "%s", node);
+	memcpy(received->interface, rec->interface, sizeof(received->interface));
+	received->raw_len = rec->event.raw_len;
+}
+
+static struct event_collector *collector_start(struct received *received, uint16_t port)
+{
+	struct event_collector_config config = {
+		.bind_addr = "127.0.0.1",
+		.port = port,
+		.any_port = port == 0,
+		.fn = on_event,
+		.ctx = received,
+	};
+	
+	return event_collector_create(&config);
+}
+
+/* Flush until the collector has count events, or five seconds pass */
+static bool wait_events(struct event_stream *stream, struct event_collector *collector,
+                        uint64_t count)
+{
+	struct event_collector_stats stats;
+	
+	for (int i = 0; i < 500; i++) {
+		event_stream_flush(stream);
+		event_collector_get_stats(collector, &stats);
+		if (stats.events >= count)
+			return stats.events == count;
+		usleep(10000);
+	}
+	return false;
+}
+
+TEST(event_stream_roundtrip)
+{
+	struct received received = {0};
+	struct event_collector_stats cstats;
+	struct event_stream_stats stats;
+	struct event_collector *collector;
+	struct event_stream *stream;
+	struct nlmon_event event;
+	unsigned char raw[NLMSG_HDRLEN + 20];
+	
+	collector = collector_start(&received, 0);
+	ASSERT_NOT_NULL(collector);
+	ASSERT_TRUE(event_collector_port(collector) != 0);
+	
+	struct event_stream_config config = {
+		.server = "127.0.0.1",
+		.port = event_collector_port(collector),
+		.node = "node-a",
+		.include_raw = true,
+		.batch_events = 100,
+	};
+	stream = event_stream_create(&config);
+	ASSERT_NOT_NULL(stream);
+	
+	memset(raw, 0x11, sizeof(raw));
+	for (int i = 0; i < 1000; i++) {
+		fill_event(&event, i);
+		event.raw_msg = (struct nlmsghdr *)raw;
+		event.raw_msg_len = i == 999 ? sizeof(raw) : 0;
+		ASSERT_TRUE(event_stream_write_event(stream, &event));
+	}
+	ASSERT_TRUE(wait_events(stream, collector, 1000));
+	
+	ASSERT_EQ(received.out_of_order, 0);
+	ASSERT_EQ(received.next, 1000);
+	ASSERT_STR_EQ(received.node, "node-a");
+	ASSERT_STR_EQ(received.interface, "eth3");
+	ASSERT_EQ(received.raw_len, sizeof(raw));
+	
+	event_stream_get_stats(stream, &stats);
+	ASSERT_EQ(stats.events, 1000);
+	ASSERT_EQ(stats.batches, 10);
+	ASSERT_TRUE(stats.connected);
+	ASSERT_EQ(stats.dropped, 0);
+	/* Similar events compress well */
+	ASSERT_TRUE(stats.bytes_sent * 4 < stats.bytes_raw);
+	
+	event_stream_destroy(stream);
+	
+	event_collector_get_stats(collector, &cstats);
+	ASSERT_EQ(cstats.batches, 10);
+	ASSERT_EQ(cstats.duplicates, 0);
+	ASSERT_EQ(cstats.nodes, 1);
+	ASSERT_EQ(cstats.errors, 0);
+	event_collector_destroy(collector);
+}
+
+/* Events of a collector outage are spilled and arrive once it is back */
+TEST(event_stream_outage_spill)
+{
+	struct received received = {0};
+	struct event_collector_stats cstats;
+	struct event_stream_stats stats;
+	struct event_collector *collector;
+	struct event_stream *stream;
+	struct nlmon_event event;
+	uint16_t port;
+	
+	/* A port nothing listens on for now */
+	collector = collector_start(&received, 0);
+	ASSERT_NOT_NULL(collector);
+	port = event_collector_port(collector);
+	event_collector_destroy(collector);
+	unlink(TEST_SPILL);
+	
+	struct event_stream_config config = {
+		.server = "127.0.0.1",
+		.port = port,
+		.node = "node-b",
+		.batch_events = 10,
+		.memory_limit = 4096,
+		.spill_path = TEST_SPILL,
+		.reconnect_interval = 3600,
+	};
+	stream = event_stream_create(&config);
+	ASSERT_NOT_NULL(stream);
+	
+	for (int i = 0; i < 1000; i++) {
+		fill_event(&event, i);
+		ASSERT_TRUE(event_stream_write_event(stream, &event));
+	}
+	ASSERT_FALSE(event_stream_flush(stream));
+	event_stream_get_stats(stream, &stats);
+	ASSERT_FALSE(stats.connected);
+	ASSERT_TRUE(stats.spilled > 0);
+	ASSERT_TRUE(stats.spill_bytes > 0);
+	ASSERT_EQ(stats.dropped, 0);
+	
+	/* A restart keeps the spilled batches, the queue is spilled too */
+	event_stream_destroy(stream);
+	ASSERT_EQ(access(TEST_SPILL, F_OK), 0);
+	
+	collector = collector_start(&received, port);
+	ASSERT_NOT_NULL(collector);
+	stream = event_stream_create(&config);
+	ASSERT_NOT_NULL(stream);
+	for (int i = 1000; i < 1100; i++) {
+		fill_event(&event, i);
+		ASSERT_TRUE(event_stream_write_event(stream, &event));
+	}
+	ASSERT_TRUE(wait_events(stream, collector, 1100));
+	ASSERT_EQ(received.out_of_order, 0);
+	ASSERT_EQ(received.next, 1100);
+	
+	event_stream_get_stats(stream, &stats);
+	ASSERT_EQ(stats.spill_bytes, 0);
+	event_stream_destroy(stream);
+	ASSERT_NE(access(TEST_SPILL, F_OK), 0);
+	
+	event_collector_get_stats(collector, &cstats);
+	ASSERT_EQ(cstats.events, 1100);
+	ASSERT_EQ(cstats.errors, 0);
+	event_collector_destroy(collector);
+}
+
+static int connect_to(uint16_t port)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+	struct timeval tv = { .tv_sec = 5 };
+	int fd;
+	
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static bool send_frame(int fd, uint16_t type, uint64_t seq, const void *payload, uint32_t len)
+{
+	struct event_stream_frame frame = {
+		.magic = htole32(EVENT_STREAM_MAGIC),
+		.type = htole16(type),
+		.codec = htole16(EVENT_STREAM_CODEC_NONE),
+		.seq = htole64(seq),
+		.len = htole32(len),
+		.raw_len = htole32(len),
+		.count = htole32(type == EVENT_STREAM_BATCH ? 1 : 0),
+		.crc = htole32(type == EVENT_STREAM_BATCH ? (uint32_t)crc32(0, payload, len) : 0),
+	};
+	
+	return write(fd, &frame, sizeof(frame)) == sizeof(frame) &&
+	       (!len || write(fd, payload, len) == (ssize_t)len);
+}
+
+static bool recv_frame(int fd, uint16_t type, uint64_t seq)
+{
+	struct event_stream_frame frame;
+	
+	return recv(fd, &frame, sizeof(frame), MSG_WAITALL) == sizeof(frame) &&
+	       le16toh(frame.type) == type && le64toh(frame.seq) == seq;
+}
+
+/* Batches sent again are acknowledged once more but handed on once */
+TEST(event_collector_duplicates)
+{
+	struct received received = {0};
+	struct event_collector_stats cstats;
+	struct event_collector *collector;
+	struct event_stream_hello hello = {
+		.version = htole16(EVENT_STREAM_VERSION),
+		.big_endian = __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__,
+		.event_size = htole32(sizeof(struct binexp_event)),
+		.node = "node-c",
+	};
+	struct {
+		struct binexp_record rec;
+		struct event_bus_record body;
+	} batch;
+	int fd;
+	
+	collector = collector_start(&received, 0);
+	ASSERT_NOT_NULL(collector);
+	
+	memset(&batch, 0, sizeof(batch));
+	batch.rec.length = sizeof(batch);
+	batch.rec.type = BINEXP_RECORD_EVENT;
+	strcpy(batch.body.interface, "wlan0");
+	
+	fd = connect_to(event_collector_port(collector));
+	ASSERT_TRUE(fd >= 0);
+	ASSERT_TRUE(send_frame(fd, EVENT_STREAM_HELLO, 0, &hello, sizeof(hello)));
+	ASSERT_TRUE(recv_frame(fd, EVENT_STREAM_WELCOME, 0));
+	ASSERT_TRUE(send_frame(fd, EVENT_STREAM_BATCH, 7, &batch, sizeof(batch)));
+	ASSERT_TRUE(recv_frame(fd, EVENT_STREAM_ACK, 7));
+	close(fd);
+	
+	/* The node reconnects and resends */
+	fd = connect_to(event_collector_port(collector));
+	ASSERT_TRUE(fd >= 0);
+	ASSERT_TRUE(send_frame(fd, EVENT_STREAM_HELLO, 0, &hello, sizeof(hello)));
+	ASSERT_TRUE(recv_frame(fd, EVENT_STREAM_WELCOME, 7));
+	ASSERT_TRUE(send_frame(fd, EVENT_STREAM_BATCH, 7, &batch, sizeof(batch)));
+	ASSERT_TRUE(recv_frame(fd, EVENT_STREAM_ACK, 7));
+	close(fd);
+	
+	event_collector_get_stats(collector, &cstats);
+	ASSERT_EQ(cstats.events, 1);
+	ASSERT_EQ(cstats.duplicates, 1);
+	ASSERT_EQ(cstats.nodes, 1);
+	ASSERT_STR_EQ(received.interface, "wlan0");
+	event_collector_destroy(collector);
+}
+
+TEST(event_collector_malformed)
+{
+	struct received received = {0};
+	struct event_collector_stats cstats;
+	struct event_collector *collector;
+	char junk[64];
+	int fd;
+	
+	collector = collector_start(&received, 0);
+	ASSERT_NOT_NULL(collector);
+	
+	/* Not a frame */
+	fd = connect_to(event_collector_port(collector));
+	ASSERT_TRUE(fd >= 0);
+	memset(junk, 'x', sizeof(junk));
+	ASSERT_EQ(write(fd, junk, sizeof(junk)), sizeof(junk));
+	ASSERT_TRUE(recv(fd, junk, sizeof(junk), 0) <= 0);
+	close(fd);
+	
+	/* A batch before the hello */
+	fd = connect_to(event_collector_port(collector));
+	ASSERT_TRUE(fd >= 0);
+	ASSERT_TRUE(send_frame(fd, EVENT_STREAM_BATCH, 1, junk, sizeof(junk)));
+	ASSERT_TRUE(recv(fd, junk, sizeof(junk), 0) <= 0);
+	close(fd);
+	
+	event_collector_get_stats(collector, &cstats);
+	ASSERT_EQ(cstats.errors, 2);
+	ASSERT_EQ(cstats.events, 0);
+	event_collector_destroy(collector);
+}
+
+TEST_SUITE_BEGIN("Event Stream")
+	RUN_TEST(event_stream_roundtrip);
+	RUN_TEST(event_stream_outage_spill);
+	RUN_TEST(event_collector_duplicates);
+	RUN_TEST(event_collector_malformed);
+TEST_SUITE_END()
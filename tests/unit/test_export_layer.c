@@ -0,0 +1,199 @@
+/* test_export_layer.c - Unit tests for the export queues */
+
+#include "test_framework.h"
+#include "export_layer.h"
+#include "event_processor.h"
+#include "io_service.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_JSON_PATH "/tmp/test_unit_export_layer.json"
+
+static size_t count_file_lines(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	size_t lines = 0;
+	int c;
+	
+	if (!fp)
+		return 0;
+	
+	while ((c = fgetc(fp)) != EOF) {
+		if (c == '\n')
+			lines++;
+	}
+	
+	fclose(fp);
+	return lines;
+}
+
+static size_t count_lines(void)
+{
+	return count_file_lines(TEST_JSON_PATH);
+}
+
+static struct export_layer *create_test_layer(bool sync_export, size_t queue_size,
+                                              enum export_overflow overflow)
+{
+	struct export_layer_config config = {
+		.enable_json = true,
+		.json_filename = TEST_JSON_PATH,
+		.json_format = JSON_FORMAT_COMPACT,
+		.json_streaming = true,
+		.sync_export = sync_export,
+	};
+	
+	config.queues[EXPORT_TARGET_JSON].size = queue_size;
+	config.queues[EXPORT_TARGET_JSON].overflow = overflow;
+	
+	unlink(TEST_JSON_PATH);
+	return export_layer_create(&config);
+}
+
+static int export_events(struct export_layer *layer, int count)
+{
+	int accepted = 0;
+	
+	for (int i = 0; i < count; i++) {
+		struct nlmon_event event = {0};
+		
+		event.timestamp = 1000000ULL * i;
+		event.sequence = i;
+		event.event_type = 1;
+		strcpy(event.interface, "eth0");
+		if (export_layer_export_event(layer, &event))
+			accepted++;
+	}
+	
+	return accepted;
+}
+
+TEST(export_layer_sync)
+{
+	struct export_layer *layer = create_test_layer(true, 0, EXPORT_OVERFLOW_DROP_NEWEST);
+	struct export_queue_stats stats;
+	
+	ASSERT_NOT_NULL(layer);
+	ASSERT_EQ(export_events(layer, 100), 100);
+	ASSERT_TRUE(export_layer_flush_all(layer));
+	ASSERT_EQ(count_lines(), 100);
+	ASSERT_FALSE(export_layer_get_queue_stats(layer, EXPORT_TARGET_JSON, &stats));
+	
+	export_layer_destroy(layer);
+	unlink(TEST_JSON_PATH);
+}
+
+TEST(export_layer_flush_barrier)
+{
+	struct export_layer *layer = create_test_layer(false, 16, EXPORT_OVERFLOW_BLOCK);
+	struct export_queue_stats stats;
+	
+	ASSERT_NOT_NULL(layer);
+	
+	/* A blocking queue loses nothing, however small */
+	ASSERT_EQ(export_events(layer, 5000), 5000);
+	ASSERT_TRUE(export_layer_flush_all(layer));
+	ASSERT_EQ(count_lines(), 5000);
+	
+	ASSERT_TRUE(export_layer_get_queue_stats(layer, EXPORT_TARGET_JSON, &stats));
+	ASSERT_EQ(stats.queued, 5000);
+	ASSERT_EQ(stats.exported, 5000);
+	ASSERT_EQ(stats.dropped, 0);
+	ASSERT_EQ(stats.queue_depth, 0);
+	ASSERT_EQ(stats.lag_us, 0);
+	
+	/* Flushing an idle queue still flushes the exporter */
+	ASSERT_TRUE(export_layer_flush_all(layer));
+	ASSERT_FALSE(export_layer_get_queue_stats(layer, EXPORT_TARGET_SYSLOG, &stats));
+	
+	export_layer_destroy(layer);
+	unlink(TEST_JSON_PATH);
+}
+
+TEST(export_layer_overflow_drops)
+{
+	struct export_layer *layer;
+	struct export_queue_stats stats;
+	int accepted;
+	
+	/* Refused events are counted, the rest all reach the file */
+	layer = create_test_layer(false, 2, EXPORT_OVERFLOW_DROP_NEWEST);
+	ASSERT_NOT_NULL(layer);
+	accepted = export_events(layer, 20000);
+	ASSERT_TRUE(export_layer_flush_all(layer));
+	ASSERT_TRUE(export_layer_get_queue_stats(layer, EXPORT_TARGET_JSON, &stats));
+	ASSERT_EQ(stats.queued, (uint64_t)accepted);
+	ASSERT_EQ(stats.queued + stats.dropped, 20000);
+	ASSERT_EQ(count_lines(), (size_t)accepted);
+	export_layer_destroy(layer);
+	
+	/* Dropping the oldest accepts every event */
+	layer = create_test_layer(false, 2, EXPORT_OVERFLOW_DROP_OLDEST);
+	ASSERT_NOT_NULL(layer);
+	ASSERT_EQ(export_events(layer, 20000), 20000);
+	ASSERT_TRUE(export_layer_flush_all(layer));
+	ASSERT_TRUE(export_layer_get_queue_stats(layer, EXPORT_TARGET_JSON, &stats));
+	ASSERT_EQ(stats.queued, 20000);
+	ASSERT_EQ(stats.exported + stats.dropped, 20000);
+	ASSERT_EQ(count_lines(), (size_t)stats.exported);
+	export_layer_destroy(layer);
+	
+	unlink(TEST_JSON_PATH);
+}
+
+TEST(export_layer_json_io_service)
+{
+	struct io_service_config io_config = { .buffer_count = 4, .buffer_size = 4096 };
+	struct io_service *io = io_service_create(&io_config);
+	struct export_layer_config config = {
+		.enable_json = true,
+		.json_filename = TEST_JSON_PATH,
+		.json_format = JSON_FORMAT_COMPACT,
+		.json_streaming = true,
+		.json_policy = { .max_file_size = 200 * 1024, .max_rotations = 8 },
+		.json_io = io,
+		.sync_export = true,
+	};
+	struct export_layer *layer;
+	struct io_service_stats stats;
+	struct json_exporter *json;
+	uint32_t rotations = 0;
+	size_t lines;
+	char path[64];
+	
+	ASSERT_NOT_NULL(io);
+	unlink(TEST_JSON_PATH);
+	layer = export_layer_create(&config);
+	ASSERT_NOT_NULL(layer);
+	
+	ASSERT_EQ(export_events(layer, 5000), 5000);
+	ASSERT_TRUE(export_layer_flush_all(layer));
+	json = export_layer_get_json(layer);
+	ASSERT_TRUE(json_exporter_get_stats(json, NULL, NULL, NULL, &rotations));
+	ASSERT_TRUE(rotations > 0);
+	
+	/* Every event is in one of the files, whole */
+	lines = count_lines();
+	for (uint32_t i = 0; i < rotations; i++) {
+		snprintf(path, sizeof(path), "%s.%u", TEST_JSON_PATH, i);
+		lines += count_file_lines(path);
+		unlink(path);
+	}
+	ASSERT_EQ(lines, 5000);
+	
+	io_service_get_stats(io, &stats);
+	ASSERT_TRUE(stats.writes > 0);
+	ASSERT_EQ(stats.errors, 0);
+	
+	export_layer_destroy(layer);
+	io_service_destroy(io);
+	unlink(TEST_JSON_PATH);
+}
+
+TEST_SUITE_BEGIN("Export Layer")
+	RUN_TEST(export_layer_sync);
+	RUN_TEST(export_layer_flush_barrier);
+	RUN_TEST(export_layer_overflow_drops);
+	RUN_TEST(export_layer_json_io_service);
+TEST_SUITE_END()
@@ -0,0 +1,237 @@
+/* test_fib_mirror.c - Unit tests for the routing table mirror */
+
+#include "test_framework.h"
+#include "fib_mirror.h"
+#include "nlmon_nl_route.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <linux/rtnetlink.h>
+
+static struct nlmon_route_info make_route(int family, const char *dst, int len,
+                                          const char *gateway, int oif)
+{
+	struct nlmon_route_info route;
+	
+	memset(&route, 0, sizeof(route));
+	route.family = family;
+	route.dst_len = (unsigned char)len;
+	route.table = RT_TABLE_MAIN;
+	route.type = RTN_UNICAST;
+	snprintf(route.dst, sizeof(route.dst), "%s", dst);
+	snprintf(route.gateway, sizeof(route.gateway), "%s", gateway);
+	route.oif = oif;
+	return route;
+}
+
+struct collected {
+	char prefixes[16][80];
+	int count;
+	int stop_after;
+};
+
+static bool collect(const struct fib_mirror_route *route, void *ctx)
+{
+	struct collected *c = ctx;
+	
+	if (c->count < 16)
+		snprintf(c->prefixes[c->count], sizeof(c->prefixes[0]), "%s/%u",
+		         route->dst, route->dst_len);
+	c->count++;
+	return c->stop_after == 0 || c->count < c->stop_after;
+}
+
+TEST(fib_longest_prefix_match)
+{
+	struct fib_mirror *fib = fib_mirror_create(0);
+	struct nlmon_route_info route;
+	struct fib_mirror_route out;
+	
+	ASSERT_NOT_NULL(fib);
+	
+	route = make_route(AF_INET, "", 0, "192.168.1.1", 2);
+	ASSERT_EQ(fib_mirror_add(fib, &route, 100), 0);
+	route = make_route(AF_INET, "10.0.0.0", 8, "192.168.1.2", 2);
+	ASSERT_EQ(fib_mirror_add(fib, &route, 100), 0);
+	route = make_route(AF_INET, "10.1.0.0", 16, "192.168.1.3", 3);
+	ASSERT_EQ(fib_mirror_add(fib, &route, 100), 0);
+	route = make_route(AF_INET, "10.1.2.0", 24, "", 4);
+	ASSERT_EQ(fib_mirror_add(fib, &route, 100), 0);
+	
+	ASSERT_TRUE(fib_mirror_lookup(fib, RT_TABLE_MAIN, "10.1.2.7", &out));
+	ASSERT_STR_EQ(out.dst, "10.1.2.0");
+	ASSERT_EQ(out.dst_len, 24);
+	ASSERT_STR_EQ(out.gateway, "");
+	ASSERT_EQ(out.oif, 4);
+	
+	ASSERT_TRUE(fib_mirror_lookup(fib, RT_TABLE_MAIN, "10.1.3.1", &out));
+	ASSERT_EQ(out.dst_len, 16);
+	ASSERT_TRUE(fib_mirror_lookup(fib, RT_TABLE_MAIN, "10.200.0.1", &out));
+	ASSERT_EQ(out.dst_len, 8);
+	ASSERT_TRUE(fib_mirror_lookup(fib, RT_TABLE_MAIN, "8.8.8.8", &out));
+	ASSERT_EQ(out.dst_len, 0);
+	ASSERT_STR_EQ(out.gateway, "192.168.1.1");
+	
+	/* Other tables and families are separate */
+	ASSERT_FALSE(fib_mirror_lookup(fib, RT_TABLE_LOCAL, "10.1.2.7", &out));
+	ASSERT_FALSE(fib_mirror_lookup(fib, RT_TABLE_MAIN, "2001:db8::1", &out));
+	ASSERT_FALSE(fib_mirror_lookup(fib, RT_TABLE_MAIN, "not an address", &out));
+	
+	/* Deleting the most specific falls back to the next one */
+	route = make_route(AF_INET, "10.1.2.0", 24, "", 4);
+	ASSERT_EQ(fib_mirror_delete(fib, &route), 0);
+	ASSERT_EQ(fib_mirror_delete(fib, &route), -ENOENT);
+	ASSERT_TRUE(fib_mirror_lookup(fib, RT_TABLE_MAIN, "10.1.2.7", &out));
+	ASSERT_EQ(out.dst_len, 16);
+	
+	fib_mirror_destroy(fib);
+}
+
+TEST(fib_covering_and_replace)
+{
+	struct fib_mirror *fib = fib_mirror_create(0);
+	struct nlmon_route_info route;
+	struct fib_mirror_route out;
+	
+	route = make_route(AF_INET6, "2001:db8::", 32, "fe80::1", 2);
+	ASSERT_EQ(fib_mirror_add(fib, &route, 100), 0);
+	
+	/* A more specific one is covered, the prefix itself is not */
+	route = make_route(AF_INET6, "2001:db8:1::", 48, "fe80::2", 3);
+	ASSERT_TRUE(fib_mirror_covering(fib, &route, &out));
+	ASSERT_STR_EQ(out.dst, "2001:db8::");
+	ASSERT_STR_EQ(out.gateway, "fe80::1");
+	route = make_route(AF_INET6, "2001:db8::", 32, "fe80::1", 2);
+	ASSERT_FALSE(fib_mirror_covering(fib, &route, &out));
+	
+	/* Same prefix and priority replaces, the timestamp follows the next hop */
+	ASSERT_EQ(fib_mirror_add(fib, &route, 200), 1);
+	ASSERT_TRUE(fib_mirror_find(fib, &route, &out));
+	ASSERT_EQ(out.since, 100);
+	route = make_route(AF_INET6, "2001:db8::", 32, "fe80::9", 2);
+	ASSERT_EQ(fib_mirror_add(fib, &route, 300), 1);
+	ASSERT_TRUE(fib_mirror_find(fib, &route, &out));
+	ASSERT_STR_EQ(out.gateway, "fe80::9");
+	ASSERT_EQ(out.since, 300);
+	
+	/* Another priority is another route, lookups prefer the lowest */
+	route.priority = 10;
+	strcpy(route.gateway, "fe80::10");
+	ASSERT_EQ(fib_mirror_add(fib, &route, 400), 0);
+	ASSERT_TRUE(fib_mirror_lookup(fib, RT_TABLE_MAIN, "2001:db8::5", &out));
+	ASSERT_EQ(out.priority, 0);
+	ASSERT_STR_EQ(out.gateway, "fe80::9");
+	route.priority = 0;
+	ASSERT_EQ(fib_mirror_delete(fib, &route), 0);
+	ASSERT_TRUE(fib_mirror_lookup(fib, RT_TABLE_MAIN, "2001:db8::5", &out));
+	ASSERT_EQ(out.priority, 10);
+	
+	/* Host routes and malformed ones */
+	route = make_route(AF_INET6, "2001:db8::1", 128, "", 5);
+	ASSERT_EQ(fib_mirror_add(fib, &route, 500), 0);
+	ASSERT_TRUE(fib_mirror_lookup(fib, RT_TABLE_MAIN, "2001:db8::1", &out));
+	ASSERT_EQ(out.dst_len, 128);
+	route.dst_len = 129;
+	ASSERT_EQ(fib_mirror_add(fib, &route, 500), -EINVAL);
+	route = make_route(AF_INET, "10.0.0.0", 8, "garbage", 2);
+	ASSERT_EQ(fib_mirror_add(fib, &route, 500), -EINVAL);
+	
+	fib_mirror_destroy(fib);
+}
+
+TEST(fib_walk_inside_prefix)
+{
+	struct fib_mirror *fib = fib_mirror_create(0);
+	const char *dsts[] = { "10.0.0.0", "10.1.0.0", "10.1.128.0", "10.2.0.0", "11.0.0.0" };
+	const int lens[] = { 8, 16, 17, 16, 8 };
+	struct nlmon_route_info route;
+	struct collected c;
+	size_t i;
+	
+	for (i = 0; i < 5; i++) {
+		route = make_route(AF_INET, dsts[i], lens[i], "192.168.1.1", 2);
+		ASSERT_EQ(fib_mirror_add(fib, &route, 100), 0);
+	}
+	
+	/* In address order, the prefix itself included */
+	memset(&c, 0, sizeof(c));
+	ASSERT_EQ(fib_mirror_walk(fib, RT_TABLE_MAIN, AF_INET, "10.0.0.0", 8, collect, &c), 4);
+	ASSERT_STR_EQ(c.prefixes[0], "10.0.0.0/8");
+	ASSERT_STR_EQ(c.prefixes[1], "10.1.0.0/16");
+	ASSERT_STR_EQ(c.prefixes[2], "10.1.128.0/17");
+	ASSERT_STR_EQ(c.prefixes[3], "10.2.0.0/16");
+	
+	memset(&c, 0, sizeof(c));
+	ASSERT_EQ(fib_mirror_walk(fib, RT_TABLE_MAIN, AF_INET, "10.1.128.0", 17, collect, &c), 1);
+	ASSERT_STR_EQ(c.prefixes[0], "10.1.128.0/17");
+	
+	memset(&c, 0, sizeof(c));
+	ASSERT_EQ(fib_mirror_walk(fib, RT_TABLE_MAIN, AF_INET, "12.0.0.0", 8, collect, &c), 0);
+	
+	/* The whole table, stopped early */
+	memset(&c, 0, sizeof(c));
+	ASSERT_EQ(fib_mirror_walk(fib, RT_TABLE_MAIN, AF_INET, NULL, 0, collect, &c), 5);
+	ASSERT_STR_EQ(c.prefixes[4], "11.0.0.0/8");
+	memset(&c, 0, sizeof(c));
+	c.stop_after = 2;
+	ASSERT_EQ(fib_mirror_walk(fib, RT_TABLE_MAIN, AF_INET, NULL, 0, collect, &c), 2);
+	
+	ASSERT_EQ(fib_mirror_walk(fib, RT_TABLE_MAIN, AF_INET, "10.0.0.0", 33, collect, &c), -EINVAL);
+	
+	fib_mirror_destroy(fib);
+}
+
+TEST(fib_nodes_are_reclaimed)
+{
+	struct fib_mirror *fib = fib_mirror_create(1000);
+	struct nlmon_route_info route;
+	struct fib_mirror_route out;
+	size_t routes, nodes, bytes;
+	char dst[32];
+	int i;
+	
+	for (i = 0; i < 1000; i++) {
+		snprintf(dst, sizeof(dst), "10.%d.%d.0", i / 256, i % 256);
+		route = make_route(AF_INET, dst, 24, "192.168.1.1", 2);
+		ASSERT_EQ(fib_mirror_add(fib, &route, i), 0);
+	}
+	
+	/* Fewer than two nodes per route */
+	fib_mirror_stats(fib, &routes, &nodes, &bytes);
+	ASSERT_EQ(routes, 1000);
+	ASSERT_TRUE(nodes < 2000);
+	ASSERT_TRUE(bytes > 0);
+	
+	/* At the limit only replacements go in */
+	route = make_route(AF_INET, "172.16.0.0", 12, "192.168.1.1", 2);
+	ASSERT_EQ(fib_mirror_add(fib, &route, 0), -ENOSPC);
+	ASSERT_FALSE(fib_mirror_lookup(fib, RT_TABLE_MAIN, "172.16.0.1", &out));
+	route = make_route(AF_INET, "10.0.5.0", 24, "192.168.1.9", 2);
+	ASSERT_EQ(fib_mirror_add(fib, &route, 0), 1);
+	
+	for (i = 0; i < 1000; i++) {
+		snprintf(dst, sizeof(dst), "10.%d.%d.0", i / 256, i % 256);
+		route = make_route(AF_INET, dst, 24, "", 0);
+		ASSERT_EQ(fib_mirror_delete(fib, &route), 0);
+	}
+	
+	fib_mirror_stats(fib, &routes, &nodes, &bytes);
+	ASSERT_EQ(routes, 0);
+	ASSERT_EQ(nodes, 0);
+	
+	/* Freed nodes are handed out again */
+	route = make_route(AF_INET, "10.0.0.0", 8, "", 2);
+	ASSERT_EQ(fib_mirror_add(fib, &route, 0), 0);
+	fib_mirror_clear(fib);
+	ASSERT_FALSE(fib_mirror_lookup(fib, RT_TABLE_MAIN, "10.0.0.1", &out));
+	
+	fib_mirror_destroy(fib);
+}
+
+TEST_SUITE_BEGIN("FIB Mirror")
+	RUN_TEST(fib_longest_prefix_match);
+	RUN_TEST(fib_covering_and_replace);
+	RUN_TEST(fib_walk_inside_prefix);
+	RUN_TEST(fib_nodes_are_reclaimed);
+TEST_SUITE_END()
@@ -0,0 +1,227 @@
+/* test_file_compress.c - Unit tests for background file compression */
+
+#include "test_framework.h"
+#include "file_compress.h"
+#include "log_rotation.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define TEST_FILE "/tmp/test_unit_file_compress.log"
+
+/* Write numbered lines, returns the bytes written */
+static size_t write_lines(const char *path, int count)
+{
+	FILE *fp = fopen(path, "w");
+	size_t bytes = 0;
+	
+	if (!fp)
+		return 0;
+	
+	for (int i = 0; i < count; i++)
+		bytes += fprintf(fp, "line %08d of the file being compressed\n", i);
+	
+	fclose(fp);
+	return bytes;
+}
+
+/* Check the .gz of path holds the lines write_lines() wrote */
+static int gz_lines(const char *path)
+{
+	char gz_name[512], line[128], expected[128];
+	int count = 0;
+	gzFile gz;
+	
+	snprintf(gz_name, sizeof(gz_name), "%s.gz", path);
+	gz = gzopen(gz_name, "rb");
+	if (!gz)
+		return -1;
+	
+	while (gzgets(gz, line, sizeof(line))) {
+		snprintf(expected, sizeof(expected), "line %08d of the file being compressed\n", count);
+		if (strcmp(line, expected) != 0) {
+			count = -1;
+			break;
+		}
+		count++;
+	}
+	
+	gzclose(gz);
+	return count;
+}
+
+TEST(file_compress_parallel_members)
+{
+	struct file_compress_config config = {
+		.level = 1,
+		.threads = 4,
+		.chunk_size = 64 * 1024,
+	};
+	struct file_compressor *fc;
+	struct file_compress_stats stats;
+	size_t bytes;
+	
+	fc = file_compressor_create(&config);
+	ASSERT_NOT_NULL(fc);
+	
+	/* Many members, the last one short */
+	bytes = write_lines(TEST_FILE, 50000);
+	ASSERT_TRUE(bytes > 0);
+	ASSERT_TRUE(file_compressor_submit(fc, TEST_FILE));
+	file_compressor_wait(fc);
+	
+	ASSERT_TRUE(access(TEST_FILE, F_OK) != 0);
+	ASSERT_EQ(gz_lines(TEST_FILE), 50000);
+	
+	ASSERT_TRUE(file_compressor_get_stats(fc, &stats));
+	ASSERT_EQ(stats.files, 1);
+	ASSERT_EQ(stats.failed, 0);
+	ASSERT_EQ(stats.pending, 0);
+	ASSERT_EQ(stats.bytes_in, bytes);
+	ASSERT_TRUE(stats.bytes_out > 0 && stats.bytes_out < bytes);
+	
+	/* Empty files and missing files */
+	write_lines(TEST_FILE, 0);
+	ASSERT_TRUE(file_compressor_submit(fc, TEST_FILE));
+	ASSERT_TRUE(file_compressor_submit(fc, TEST_FILE ".missing"));
+	file_compressor_wait(fc);
+	ASSERT_EQ(gz_lines(TEST_FILE), 0);
+	ASSERT_TRUE(file_compressor_get_stats(fc, &stats));
+	ASSERT_EQ(stats.files, 2);
+	ASSERT_EQ(stats.failed, 1);
+	
+	file_compressor_destroy(fc);
+	unlink(TEST_FILE ".gz");
+}
+
+TEST(file_compress_destroy_drains)
+{
+	struct file_compressor *fc;
+	char path[64];
+	
+	fc = file_compressor_create(NULL);
+	ASSERT_NOT_NULL(fc);
+	
+	for (int i = 0; i < 8; i++) {
+		snprintf(path, sizeof(path), "%s.%d", TEST_FILE, i);
+		write_lines(path, 1000 * (i + 1));
+		ASSERT_TRUE(file_compressor_submit(fc, path));
+	}
+	
+	file_compressor_destroy(fc);
+	
+	for (int i = 0; i < 8; i++) {
+		snprintf(path, sizeof(path), "%s.%d", TEST_FILE, i);
+		ASSERT_EQ(gz_lines(path), 1000 * (i + 1));
+		strcat(path, ".gz");
+		unlink(path);
+	}
+}
+
+TEST(file_compress_log_rotation)
+{
+	struct log_rotation_policy policy = {
+		.trigger = ROTATION_TRIGGER_SIZE,
+		.max_file_size = 4096,
+		.max_rotations = 3,
+		.compress_rotated = true,
+		.compress_threads = 2,
+	};
+	struct log_rotator *rotator;
+	char path[64];
+	uint32_t rotations = 0;
+	
+	unlink(TEST_FILE);
+	rotator = log_rotator_create(TEST_FILE, &policy);
+	ASSERT_NOT_NULL(rotator);
+	
+	for (int i = 0; i < 1000; i++)
+		ASSERT_TRUE(log_rotator_printf(rotator, "line %08d of the file being compressed\n", i) > 0);
+	
+	ASSERT_TRUE(log_rotator_get_stats(rotator, NULL, NULL, &rotations, NULL, NULL));
+	ASSERT_TRUE(rotations > 3);
+	log_rotator_destroy(rotator);
+	
+	/* Every kept rotation is compressed, .0 to .max_rotations */
+	for (int i = 0; i <= 4; i++) {
+		snprintf(path, sizeof(path), "%s.%d", TEST_FILE, i);
+		ASSERT_TRUE(access(path, F_OK) != 0);
+		strcat(path, ".gz");
+		ASSERT_EQ(access(path, F_OK), i <= 3 ? 0 : -1);
+		unlink(path);
+	}
+	
+	unlink(TEST_FILE);
+}
+
+TEST(file_compress_background_rotation)
+{
+	struct log_rotation_policy policy = {
+		.trigger = ROTATION_TRIGGER_SIZE,
+		.max_rotations = 3,
+	};
+	struct log_rotation_latency latency;
+	struct log_rotator *rotator;
+	char path[64], line[64];
+	uint32_t rotations = 0;
+	FILE *fp;
+	
+	unlink(TEST_FILE);
+	rotator = log_rotator_create(TEST_FILE, &policy);
+	ASSERT_NOT_NULL(rotator);
+	
+	/* Rotate after each line, the rotation thread catches up later */
+	for (int i = 0; i < 6; i++) {
+		ASSERT_TRUE(log_rotator_printf(rotator, "file %d\n", i) > 0);
+		ASSERT_TRUE(log_rotator_force_rotation(rotator));
+	}
+	ASSERT_TRUE(log_rotator_printf(rotator, "file 6\n") > 0);
+	ASSERT_TRUE(log_rotator_flush(rotator));
+	
+	log_rotator_wait(rotator);
+	ASSERT_TRUE(log_rotator_get_stats(rotator, NULL, NULL, &rotations, NULL, &latency));
+	ASSERT_EQ(rotations, 6);
+	ASSERT_EQ(latency.pending, 0);
+	ASSERT_TRUE(latency.swap_ns_max > 0);
+	ASSERT_TRUE(latency.rotation_us_max >= latency.swap_ns_max / 1000);
+	
+	/* The base file is the newest, .0 to .3 the ones before it */
+	for (int i = -1; i <= 3; i++) {
+		if (i < 0)
+			snprintf(path, sizeof(path), "%s", TEST_FILE);
+		else
+			snprintf(path, sizeof(path), "%s.%d", TEST_FILE, i);
+		fp = fopen(path, "r");
+		ASSERT_NOT_NULL(fp);
+		ASSERT_NOT_NULL(fgets(line, sizeof(line), fp));
+		fclose(fp);
+		snprintf(path, sizeof(path), "file %d\n", 5 - i);
+		ASSERT_STR_EQ(line, path);
+	}
+	
+	snprintf(path, sizeof(path), "%s.4", TEST_FILE);
+	ASSERT_TRUE(access(path, F_OK) != 0);
+	
+	log_rotator_destroy(rotator);
+	
+	/* Nothing is left of the pre-opened or renamed-aside files */
+	snprintf(path, sizeof(path), "%s.next", TEST_FILE);
+	ASSERT_TRUE(access(path, F_OK) != 0);
+	snprintf(path, sizeof(path), "%s.rotating.0", TEST_FILE);
+	ASSERT_TRUE(access(path, F_OK) != 0);
+	
+	for (int i = 0; i <= 3; i++) {
+		snprintf(path, sizeof(path), "%s.%d", TEST_FILE, i);
+		unlink(path);
+	}
+	unlink(TEST_FILE);
+}
+
+TEST_SUITE_BEGIN("File Compression")
+	RUN_TEST(file_compress_parallel_members);
+	RUN_TEST(file_compress_destroy_drains);
+	RUN_TEST(file_compress_log_rotation);
+	RUN_TEST(file_compress_background_rotation);
+TEST_SUITE_END()
@@ -0,0 +1,144 @@
+/* test_filter_cache.c - Unit tests for the shared filter cache */
+
+#include "test_framework.h"
+#include "filter_cache.h"
+#include "filter_parser.h"
+#include "filter_compiler.h"
+#include "filter_eval.h"
+#include "event_processor.h"
+#include <stdio.h>
+#include <string.h>
+
+static bool matches(struct filter_bytecode *bytecode, const char *interface, uint32_t type)
+{
+	struct nlmon_event event;
+	
+	memset(&event, 0, sizeof(event));
+	snprintf(event.interface, sizeof(event.interface), "%s", interface);
+	event.event_type = type;
+	return filter_eval(bytecode, &event, NULL);
+}
+
+TEST(filter_cache_shares_equal_expressions)
+{
+	struct filter_bytecode *a, *b, *c, *d;
+	struct filter_cache_stats stats;
+	
+	filter_cache_clear();
+	
+	a = filter_cache_get("interface == \"eth0\" AND event_type IN [1, 2]", NULL);
+	ASSERT_NOT_NULL(a);
+	
+	/* Whitespace only, found by text without parsing */
+	b = filter_cache_get("  interface ==  \"eth0\" AND\tevent_type IN [1, 2] ", NULL);
+	ASSERT_TRUE(a == b);
+	
+	/* Operands and list items reordered, constant first */
+	c = filter_cache_get("event_type IN [2, 1] and \"eth0\" == interface", NULL);
+	ASSERT_TRUE(a == c);
+	
+	/* Whitespace inside a string is part of the value */
+	d = filter_cache_get("interface == \"eth 0\" AND event_type IN [1, 2]", NULL);
+	ASSERT_NOT_NULL(d);
+	ASSERT_TRUE(a != d);
+	
+	ASSERT_TRUE(matches(a, "eth0", 2));
+	ASSERT_FALSE(matches(a, "eth0", 3));
+	ASSERT_FALSE(matches(d, "eth0", 1));
+	
+	filter_cache_get_stats(&stats);
+	ASSERT_EQ(stats.entries, 2);
+	ASSERT_EQ(stats.misses, 2);
+	ASSERT_EQ(stats.canonical_hits, 1);
+	ASSERT_EQ(stats.aliases, 3);
+	
+	/* The text of the second lookup now skips the parser */
+	filter_bytecode_free(filter_cache_get("event_type IN [2, 1] and \"eth0\" == interface", NULL));
+	filter_cache_get_stats(&stats);
+	ASSERT_EQ(stats.hits, 2);
+	
+	filter_bytecode_free(a);
+	filter_bytecode_free(b);
+	filter_bytecode_free(c);
+	filter_bytecode_free(d);
+}
+
+TEST(filter_cache_keeps_semantics)
+{
+	struct filter_bytecode *a, *b, *lt, *gt;
+	
+	filter_cache_clear();
+	
+	/* A chain is only sorted before its first operand that may fail */
+	a = filter_cache_get("netlink.link.mtu > 1000 OR interface == \"eth0\"", NULL);
+	b = filter_cache_get("interface == \"eth0\" OR netlink.link.mtu > 1000", NULL);
+	ASSERT_NOT_NULL(a);
+	ASSERT_NOT_NULL(b);
+	ASSERT_TRUE(a != b);
+	ASSERT_FALSE(matches(a, "eth0", 1));
+	ASSERT_TRUE(matches(b, "eth0", 1));
+	
+	/* A mirrored comparison is the same, a flipped one is not */
+	lt = filter_cache_get("5 < event_type", NULL);
+	gt = filter_cache_get("event_type > 5", NULL);
+	ASSERT_TRUE(lt == gt);
+	filter_bytecode_free(gt);
+	gt = filter_cache_get("event_type < 5", NULL);
+	ASSERT_TRUE(lt != gt);
+	ASSERT_TRUE(matches(lt, "", 6));
+	ASSERT_FALSE(matches(gt, "", 6));
+	
+	filter_bytecode_free(a);
+	filter_bytecode_free(b);
+	filter_bytecode_free(lt);
+	filter_bytecode_free(gt);
+}
+
+TEST(filter_cache_references)
+{
+	struct filter_parse_error error = { .message = "" };
+	struct filter_cache_stats stats;
+	struct filter_bytecode *held, *again;
+	struct filter_expr *expr;
+	char text[64];
+	
+	filter_cache_clear();
+	
+	/* Invalid expressions report their error and are not kept */
+	ASSERT_NULL(filter_cache_get("interface ==", &error));
+	ASSERT_TRUE(error.message[0] != '\0');
+	filter_cache_get_stats(&stats);
+	ASSERT_EQ(stats.entries, 0);
+	
+	/* Parsed callers share with text callers */
+	held = filter_cache_get("event_type == 7", NULL);
+	expr = filter_parse("event_type==7");
+	ASSERT_NOT_NULL(expr);
+	again = filter_cache_get_expr(expr);
+	filter_expr_free(expr);
+	ASSERT_TRUE(held == again);
+	filter_bytecode_free(again);
+	
+	/* Evicted and cleared programs stay valid for their holders */
+	for (int i = 0; i < FILTER_CACHE_MAX + 10; i++) {
+		snprintf(text, sizeof(text), "event_type == %d", 1000 + i);
+		filter_bytecode_free(filter_cache_get(text, NULL));
+	}
+	filter_cache_get_stats(&stats);
+	ASSERT_EQ(stats.entries, FILTER_CACHE_MAX);
+	ASSERT_TRUE(stats.evictions >= 10);
+	ASSERT_TRUE(matches(held, "", 7));
+	
+	filter_cache_clear();
+	filter_cache_get_stats(&stats);
+	ASSERT_EQ(stats.entries, 0);
+	ASSERT_EQ(stats.aliases, 0);
+	ASSERT_TRUE(matches(held, "", 7));
+	filter_bytecode_free(held);
+}
+
+TEST_SUITE_BEGIN("Filter Cache")
+	RUN_TEST(filter_cache_shares_equal_expressions);
+	RUN_TEST(filter_cache_keeps_semantics);
+	RUN_TEST(filter_cache_references);
+TEST_SUITE_END()
@@ -0,0 +1,257 @@
+/* test_filter_cbpf.c - Unit tests for the classic BPF prefilter
+ *
+ * Programs are attached to a UNIX datagram socket, so the kernel runs
+ * them on the same bytes a netlink socket would see, and their decision
+ * is checked against filter_eval() on the event of the first message.
+ */
+
+#include "test_framework.h"
+#include "filter_parser.h"
+#include "filter_compiler.h"
+#include "filter_eval.h"
+#include "event_processor.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/rtnetlink.h>
+
+struct message {
+	uint16_t type;
+	uint16_t flags;
+	uint32_t seq;
+	uint32_t pid;
+	uint8_t cmd;                     /* Generic netlink only */
+	uint8_t version;
+};
+
+static const struct message messages[] = {
+	{ RTM_NEWLINK, 0, 7, 0, 0, 0 },
+	{ RTM_DELLINK, NLM_F_ACK, 8, 1234, 0, 0 },
+	{ RTM_NEWADDR, 0, 4294967295u, 4294967295u, 0, 0 },
+	{ RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE, 1, 42, 0, 0 },
+	{ 0xffff, 0, 0, 0, 0, 0 },
+	{ 28, 0, 7, 0, 3, 1 },
+	{ 30, 0, 7, 0, 4, 2 },
+};
+
+#define MESSAGE_COUNT (sizeof(messages) / sizeof(messages[0]))
+
+static const char *expressions[] = {
+	"netlink.msg_type == 16",
+	"netlink.msg_type != 16",
+	"netlink.msg_type == 65552",
+	"netlink.msg_type != 65552",
+	"netlink.msg_type IN [16, 65552]",
+	"netlink.msg_type IN [17, 20]",
+	"netlink.msg_type > 17",
+	"netlink.msg_type >= 65535",
+	"netlink.msg_type < 65536",
+	"65552 > netlink.msg_type",
+	"netlink.msg_type <= 20 AND netlink.seq == 7",
+	"netlink.seq >= 4294967295",
+	"netlink.pid == 4294967296",
+	"netlink.pid != 4294967296",
+	"netlink.msg_flags == 1280",
+	"netlink.msg_flags > 4",
+	"NOT netlink.msg_type == 16",
+	"NOT (netlink.msg_type == 16 OR netlink.seq == 8)",
+	"netlink.msg_type == 16 AND interface == \"eth0\"",
+	"netlink.msg_type == 20 OR netlink.pid == 42",
+	"netlink.protocol == 0",
+	"netlink.protocol == 16",
+	"netlink.genl_cmd == 3",
+	"netlink.genl_cmd != 300",
+	"netlink.genl_version >= 2",
+	"netlink.genl_family_id == 28",
+};
+
+#define EXPRESSION_COUNT (sizeof(expressions) / sizeof(expressions[0]))
+
+/* One message of the datagram, 32 bytes */
+static size_t put_message(uint8_t *buf, const struct message *m, int protocol)
+{
+	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+	struct genlmsghdr *genl = (struct genlmsghdr *)(buf + NLMSG_HDRLEN);
+	
+	memset(buf, 0, 32);
+	nlh->nlmsg_len = 32;
+	nlh->nlmsg_type = m->type;
+	nlh->nlmsg_flags = m->flags;
+	nlh->nlmsg_seq = m->seq;
+	nlh->nlmsg_pid = m->pid;
+	if (protocol == NETLINK_GENERIC) {
+		genl->cmd = m->cmd;
+		genl->version = m->version;
+	}
+	return 32;
+}
+
+/* The event nlmon builds from the message */
+static void make_event(struct nlmon_event *event, const struct message *m, int protocol)
+{
+	memset(event, 0, sizeof(*event));
+	event->netlink.protocol = protocol;
+	event->netlink.msg_type = m->type;
+	event->netlink.msg_flags = m->flags;
+	event->netlink.seq = m->seq;
+	event->netlink.pid = m->pid;
+	if (protocol == NETLINK_GENERIC) {
+		event->netlink.genl_cmd = m->cmd;
+		event->netlink.genl_version = m->version;
+		event->netlink.genl_family_id = m->type;
+	}
+}
+
+/* Whether the kernel passes the datagram through the attached program */
+static bool kernel_accepts(int fds[2], const void *buf, size_t len)
+{
+	uint8_t rx[256];
+	
+	if (send(fds[0], buf, len, 0) != (ssize_t)len)
+		return false;
+	return recv(fds[1], rx, sizeof(rx), MSG_DONTWAIT) == (ssize_t)len;
+}
+
+static struct filter_expr *parse(const char *text)
+{
+	struct filter_expr *expr = filter_parse(text);
+	
+	if (expr && !expr->valid) {
+		filter_expr_free(expr);
+		return NULL;
+	}
+	return expr;
+}
+
+TEST(cbpf_matches_filter_eval)
+{
+	static const int protocols[] = { NETLINK_ROUTE, NETLINK_GENERIC };
+	struct nlmon_event event;
+	uint8_t buf[32];
+	int fds[2], compiled = 0;
+	
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds), 0);
+	
+	for (size_t e = 0; e < EXPRESSION_COUNT; e++) {
+		struct filter_expr *expr = parse(expressions[e]);
+		struct filter_bytecode *bytecode;
+	
+		ASSERT_NOT_NULL(expr);
+		bytecode = filter_compile(expr);
+		ASSERT_NOT_NULL(bytecode);
+	
+		for (size_t p = 0; p < sizeof(protocols) / sizeof(protocols[0]); p++) {
+			struct filter_cbpf *prog = NULL;
+			int ret = filter_compile_cbpf(expr, protocols[p], &prog);
+	
+			if (ret == -ENOTSUP)
+				continue;
+			ASSERT_EQ(ret, 0);
+			ASSERT_EQ(filter_cbpf_attach(fds[1], prog), 0);
+			compiled++;
+	
+			for (size_t m = 0; m < MESSAGE_COUNT; m++) {
+				bool user, kernel;
+	
+				put_message(buf, &messages[m], protocols[p]);
+				make_event(&event, &messages[m], protocols[p]);
+				user = filter_eval(bytecode, &event, NULL);
+				kernel = kernel_accepts(fds, buf, sizeof(buf));
+	
+				/* Never drop what user space keeps, exact programs agree */
+				if (user && !kernel)
+					printf("  dropped: %s, message %zu\n", expressions[e], m);
+				ASSERT_TRUE(kernel || !user);
+				if (!prog->relaxed)
+					ASSERT_EQ(kernel, user);
+			}
+			filter_cbpf_free(prog);
+		}
+		filter_bytecode_free(bytecode);
+		filter_expr_free(expr);
+	}
+	ASSERT_TRUE(compiled > 0);
+	
+	close(fds[0]);
+	close(fds[1]);
+}
+
+TEST(cbpf_constant_out_of_field_range)
+{
+	struct filter_expr *expr;
+	struct filter_cbpf *prog = NULL;
+	
+	/* No 16 bit type is 65552, the comparison cannot be lowered */
+	expr = parse("netlink.msg_type != 65552");
+	ASSERT_NOT_NULL(expr);
+	ASSERT_EQ(filter_compile_cbpf(expr, NETLINK_ROUTE, &prog), -ENOTSUP);
+	filter_expr_free(expr);
+	
+	expr = parse("netlink.msg_type == 16 AND netlink.genl_cmd IN [1, 256]");
+	ASSERT_NOT_NULL(expr);
+	ASSERT_EQ(filter_compile_cbpf(expr, NETLINK_GENERIC, &prog), 0);
+	ASSERT_TRUE(prog->relaxed);
+	filter_cbpf_free(prog);
+	filter_expr_free(expr);
+}
+
+TEST(cbpf_passes_batches_errors_and_dumps)
+{
+	struct message drop = { RTM_NEWLINK, 0, 1, 0, 0, 0 };
+	struct filter_expr *expr = parse("netlink.msg_type == 20");
+	struct filter_cbpf *prog = NULL;
+	struct nlmsgerr *err;
+	uint8_t buf[96];
+	int fds[2];
+	
+	ASSERT_NOT_NULL(expr);
+	ASSERT_EQ(filter_compile_cbpf(expr, NETLINK_ROUTE, &prog), 0);
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds), 0);
+	ASSERT_EQ(filter_cbpf_attach(fds[1], prog), 0);
+	
+	/* A lone non-matching message is dropped */
+	put_message(buf, &drop, NETLINK_ROUTE);
+	ASSERT_FALSE(kernel_accepts(fds, buf, 32));
+	
+	/* Only the first of several messages is visible, batches are kept
+	 * whatever comes first */
+	for (int count = 2; count <= 3; count++) {
+		for (int i = 0; i < count; i++)
+			put_message(buf + 32 * i, &drop, NETLINK_ROUTE);
+		ASSERT_TRUE(kernel_accepts(fds, buf, 32 * count));
+	}
+	
+	/* Multipart dump replies */
+	drop.flags = NLM_F_MULTI;
+	put_message(buf, &drop, NETLINK_ROUTE);
+	ASSERT_TRUE(kernel_accepts(fds, buf, 32));
+	
+	/* Errors, acks and dump terminators */
+	drop.flags = 0;
+	drop.type = NLMSG_ERROR;
+	put_message(buf, &drop, NETLINK_ROUTE);
+	err = NLMSG_DATA(buf);
+	err->error = -ENOENT;
+	ASSERT_TRUE(kernel_accepts(fds, buf, 32));
+	drop.type = NLMSG_DONE;
+	put_message(buf, &drop, NETLINK_ROUTE);
+	ASSERT_TRUE(kernel_accepts(fds, buf, 32));
+	
+	/* Runts are left to user space */
+	ASSERT_TRUE(kernel_accepts(fds, buf, 8));
+	
+	close(fds[0]);
+	close(fds[1]);
+	filter_cbpf_free(prog);
+	filter_expr_free(expr);
+}
+
+TEST_SUITE_BEGIN("Classic BPF Prefilter")
+	RUN_TEST(cbpf_matches_filter_eval);
+	RUN_TEST(cbpf_constant_out_of_field_range);
+	RUN_TEST(cbpf_passes_batches_errors_and_dumps);
+TEST_SUITE_END()
@@ -0,0 +1,195 @@
+/* test_filter_jit.c - Unit tests for the native filter backend
+ *
+ * Every expression is evaluated by the interpreter and by the generated
+ * code on every event, before and after optimization, and the results
+ * must agree. Built with -DFILTER_JIT_DISABLE the same tests check that
+ * filter_eval() falls back to the interpreter when no code generator
+ * exists.
+ */
+
+#include "test_framework.h"
+#include "filter_parser.h"
+#include "filter_compiler.h"
+#include "filter_eval.h"
+#include "filter_jit.h"
+#include "event_processor.h"
+#include <string.h>
+
+static const char *interfaces[] = { "eth0", "eth1", "veth1", "wlan0", "" };
+
+#define INTERFACE_COUNT (sizeof(interfaces) / sizeof(interfaces[0]))
+
+static const char *expressions[] = {
+	"message_type == 16",
+	"message_type != 16",
+	"message_type < 17",
+	"message_type > 17",
+	"message_type <= 20",
+	"message_type >= 20",
+	"message_type IN [16, 17]",
+	"message_type IN [14, 15, 16, 17, 18, 19, 20, 21]",
+	"message_type >= 16 AND message_type <= 19",
+	"interface == \"eth0\"",
+	"interface != \"eth0\"",
+	"interface =~ \"veth.*\"",
+	"interface !~ \"^eth[0-9]$\"",
+	"interface IN [\"eth0\", \"wlan0\"]",
+	"NOT interface == \"eth1\"",
+	"event_type == 2 OR sequence > 10",
+	"netlink.msg_type == 20 AND netlink.seq != 3",
+	"netlink.msg_flags >= 2 OR netlink.pid == 7",
+	"(interface == \"eth0\" AND message_type == 16) OR "
+	"(interface =~ \"veth.*\" AND message_type IN [16, 17])",
+	"NOT (message_type == 16 OR message_type == 20) AND interface != \"\"",
+	"(message_type < 18 OR event_type > 1) AND NOT (sequence == 4 AND interface =~ \"eth\")",
+	"message_type == 16 AND message_type == 17",
+	"message_type == 16 OR message_type != 16",
+};
+
+#define EXPRESSION_COUNT (sizeof(expressions) / sizeof(expressions[0]))
+
+/* Events covering every interface and message type 14 to 21 */
+#define EVENT_COUNT (INTERFACE_COUNT * 8)
+
+static void make_event(struct nlmon_event *event, size_t i)
+{
+	memset(event, 0, sizeof(*event));
+	snprintf(event->interface, sizeof(event->interface), "%s",
+	         interfaces[i % INTERFACE_COUNT]);
+	event->message_type = 14 + i / INTERFACE_COUNT;
+	event->event_type = i % 3;
+	event->sequence = i;
+	event->netlink.msg_type = event->message_type;
+	event->netlink.msg_flags = i % 4;
+	event->netlink.seq = i % 5;
+	event->netlink.pid = i % 8;
+}
+
+static struct filter_bytecode *compile(const char *text, bool optimize)
+{
+	struct filter_expr *expr = filter_parse(text);
+	struct filter_bytecode *bytecode = NULL;
+	
+	if (expr && expr->valid)
+		bytecode = filter_compile(expr);
+	if (bytecode && optimize)
+		filter_bytecode_optimize(bytecode);
+	filter_expr_free(expr);
+	return bytecode;
+}
+
+/* Interpreter result, or -1 for an evaluation error */
+static int interpret(struct filter_bytecode *bytecode, struct nlmon_event *event,
+                     struct filter_eval_context *ctx)
+{
+	int ret = filter_eval_predicate(bytecode, event, ctx);
+	
+	return ret < 0 ? -1 : ret > 0;
+}
+
+TEST(jit_matches_interpreter)
+{
+	struct filter_eval_context *ctx = filter_eval_context_create();
+	struct nlmon_event event;
+	
+	ASSERT_NOT_NULL(ctx);
+	
+	for (size_t e = 0; e < EXPRESSION_COUNT; e++) {
+		for (int optimize = 0; optimize <= 1; optimize++) {
+			struct filter_bytecode *reference = compile(expressions[e], false);
+			struct filter_bytecode *bytecode = compile(expressions[e], optimize);
+	
+			ASSERT_NOT_NULL(reference);
+			ASSERT_NOT_NULL(bytecode);
+			ASSERT_EQ(filter_jit_compile(bytecode), filter_jit_available());
+	
+			for (size_t i = 0; i < EVENT_COUNT; i++) {
+				bool native = false;
+				int expected;
+	
+				make_event(&event, i);
+				expected = interpret(reference, &event, ctx);
+				ASSERT_TRUE(expected >= 0);
+	
+				ASSERT_EQ(filter_jit_run(bytecode, &event, ctx, &native),
+				          filter_jit_available());
+				if (!filter_jit_available())
+					native = filter_eval(bytecode, &event, ctx);
+				if (native != (bool)expected)
+					printf("  %s, %s on event %zu\n", expressions[e],
+					       optimize ? "optimized" : "plain", i);
+				ASSERT_EQ(native, (bool)expected);
+				ASSERT_EQ(filter_eval(bytecode, &event, ctx), (bool)expected);
+			}
+			filter_bytecode_free(bytecode);
+			filter_bytecode_free(reference);
+		}
+	}
+	
+	filter_eval_context_destroy(ctx);
+}
+
+TEST(jit_release_falls_back_to_interpreter)
+{
+	struct filter_eval_context *ctx = filter_eval_context_create();
+	struct filter_bytecode *bytecode = compile(expressions[EXPRESSION_COUNT - 5], true);
+	struct nlmon_event event;
+	bool native;
+	
+	ASSERT_NOT_NULL(ctx);
+	ASSERT_NOT_NULL(bytecode);
+	ASSERT_EQ(filter_jit_compile(bytecode), filter_jit_available());
+	
+	filter_jit_release(bytecode);
+	filter_jit_release(bytecode);
+	for (size_t i = 0; i < EVENT_COUNT; i++) {
+		make_event(&event, i);
+		ASSERT_FALSE(filter_jit_run(bytecode, &event, ctx, &native));
+		ASSERT_EQ(filter_eval(bytecode, &event, ctx),
+		          interpret(bytecode, &event, ctx) == 1);
+	}
+	
+	filter_bytecode_free(bytecode);
+	filter_eval_context_destroy(ctx);
+}
+
+TEST(jit_threshold)
+{
+	struct filter_eval_context *ctx = filter_eval_context_create();
+	struct filter_bytecode *bytecode = compile(expressions[EXPRESSION_COUNT - 5], false);
+	struct nlmon_event event;
+	uint64_t elapsed;
+	bool native;
+	
+	ASSERT_NOT_NULL(ctx);
+	ASSERT_NOT_NULL(bytecode);
+	
+	/* A threshold of 0 never compiles */
+	filter_jit_set_threshold(0);
+	for (size_t i = 0; i < EVENT_COUNT; i++) {
+		make_event(&event, i);
+		ASSERT_EQ(filter_eval_with_profiling(bytecode, &event, ctx, &elapsed),
+		          interpret(bytecode, &event, ctx) == 1);
+	}
+	ASSERT_FALSE(filter_jit_run(bytecode, &event, ctx, &native));
+	
+	/* Hot filters are compiled where a code generator exists */
+	filter_jit_set_threshold(4);
+	for (size_t i = 0; i < EVENT_COUNT; i++) {
+		make_event(&event, i);
+		ASSERT_EQ(filter_eval_with_profiling(bytecode, &event, ctx, &elapsed),
+		          interpret(bytecode, &event, ctx) == 1);
+	}
+	ASSERT_EQ(filter_jit_run(bytecode, &event, ctx, &native), filter_jit_available());
+	
+	filter_jit_set_threshold(FILTER_JIT_DEFAULT_THRESHOLD);
+	ASSERT_EQ(filter_jit_threshold(), FILTER_JIT_DEFAULT_THRESHOLD);
+	filter_bytecode_free(bytecode);
+	filter_eval_context_destroy(ctx);
+}
+
+TEST_SUITE_BEGIN("Filter JIT")
+	RUN_TEST(jit_matches_interpreter);
+	RUN_TEST(jit_release_falls_back_to_interpreter);
+	RUN_TEST(jit_threshold);
+TEST_SUITE_END()
@@ -0,0 +1,151 @@
+/* test_filter_predicate.c - Unit tests for native filter predicates */
+
+#include "test_framework.h"
+#include "filter_predicate.h"
+#include "filter_parser.h"
+#include "filter_compiler.h"
+#include "filter_eval.h"
+#include "event_processor.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+/* Calls of each predicate */
+static int prefix_calls;
+static int even_calls;
+
+static int has_prefix(const struct nlmon_event *event, const char *string,
+                      int64_t number, void *data)
+{
+	(void)number;
+	(void)data;
+	prefix_calls++;
+	return strncmp(event->interface, string, strlen(string)) == 0;
+}
+
+static int even_type(const struct nlmon_event *event, const char *string,
+                     int64_t number, void *data)
+{
+	(void)string;
+	(void)number;
+	(void)data;
+	even_calls++;
+	return event->event_type % 2 == 0;
+}
+
+static struct filter_bytecode *compile(const char *text)
+{
+	struct filter_expr *expr = filter_parse(text);
+	struct filter_bytecode *bytecode;
+	
+	if (!expr)
+		return NULL;
+	bytecode = filter_compile(expr);
+	filter_expr_free(expr);
+	if (bytecode)
+		filter_bytecode_optimize(bytecode);
+	return bytecode;
+}
+
+static bool matches(struct filter_bytecode *bytecode, const char *interface, uint32_t type)
+{
+	struct nlmon_event event;
+	
+	memset(&event, 0, sizeof(event));
+	snprintf(event.interface, sizeof(event.interface), "%s", interface);
+	event.event_type = type;
+	return filter_eval(bytecode, &event, NULL);
+}
+
+TEST(filter_predicate_calls)
+{
+	struct filter_parse_error error;
+	struct filter_bytecode *bytecode;
+	
+	ASSERT_TRUE(filter_predicate_register("has_prefix", has_prefix, FILTER_PREDICATE_ARG_STRING,
+	                                      500, NULL, NULL) >= 0);
+	ASSERT_TRUE(filter_predicate_register("even_type", even_type, FILTER_PREDICATE_ARG_NONE,
+	                                      50, NULL, NULL) >= 0);
+	ASSERT_EQ(filter_predicate_register("even_type", even_type, FILTER_PREDICATE_ARG_NONE,
+	                                    50, NULL, NULL), -EEXIST);
+	ASSERT_EQ(filter_predicate_register("and", even_type, FILTER_PREDICATE_ARG_NONE,
+	                                    50, NULL, NULL), -EINVAL);
+	
+	bytecode = compile("has_prefix(\"wlan\") OR event_type == 7");
+	ASSERT_NOT_NULL(bytecode);
+	ASSERT_TRUE(matches(bytecode, "wlan0", 1));
+	ASSERT_TRUE(matches(bytecode, "eth0", 7));
+	ASSERT_FALSE(matches(bytecode, "eth0", 1));
+	filter_bytecode_free(bytecode);
+	
+	/* Unknown names and wrong arguments do not parse */
+	ASSERT_FALSE(filter_validate("no_such(1)", &error));
+	ASSERT_STR_EQ(error.message, "Unknown predicate");
+	ASSERT_FALSE(filter_validate("has_prefix(1)", NULL));
+	ASSERT_FALSE(filter_validate("has_prefix()", NULL));
+	ASSERT_FALSE(filter_validate("even_type(\"x\")", NULL));
+	ASSERT_FALSE(filter_validate("even_type() == 1", NULL));
+	ASSERT_FALSE(filter_validate("event_type IN [even_type()]", NULL));
+	ASSERT_TRUE(filter_validate("NOT even_type()", NULL));
+}
+
+TEST(filter_predicate_scheduling)
+{
+	struct filter_bytecode *bytecode;
+	char text[1024];
+	
+	/* Calls run after the comparisons, the cheaper call first */
+	bytecode = compile("has_prefix(\"wlan\") AND even_type() AND interface == \"wlan1\"");
+	ASSERT_NOT_NULL(bytecode);
+	filter_bytecode_disassemble(bytecode, text, sizeof(text));
+	ASSERT_TRUE(strstr(text, "CALL even_type") < strstr(text, "CALL has_prefix \"wlan\""));
+	ASSERT_TRUE(strstr(text, "FIELD_CMP_STRING") < strstr(text, "CALL even_type"));
+	
+	prefix_calls = even_calls = 0;
+	ASSERT_FALSE(matches(bytecode, "eth0", 2));
+	ASSERT_EQ(prefix_calls + even_calls, 0);
+	ASSERT_FALSE(matches(bytecode, "wlan1", 1));
+	ASSERT_EQ(even_calls, 1);
+	ASSERT_EQ(prefix_calls, 0);
+	ASSERT_TRUE(matches(bytecode, "wlan1", 2));
+	ASSERT_EQ(prefix_calls, 1);
+	filter_bytecode_free(bytecode);
+	
+	/* Nothing moves in front of a field events may not carry */
+	bytecode = compile("even_type() OR netlink.link.mtu > 1000");
+	ASSERT_NOT_NULL(bytecode);
+	ASSERT_TRUE(matches(bytecode, "eth0", 2));
+	filter_bytecode_free(bytecode);
+}
+
+TEST(filter_predicate_unregister)
+{
+	struct filter_bytecode *bytecode;
+	int id;
+	
+	id = filter_predicate_lookup("even_type", NULL);
+	ASSERT_TRUE(id >= 0);
+	bytecode = compile("even_type()");
+	ASSERT_NOT_NULL(bytecode);
+	ASSERT_TRUE(matches(bytecode, "eth0", 2));
+	
+	/* Compiled calls stop matching, new filters do not parse */
+	ASSERT_EQ(filter_predicate_unregister("even_type"), 0);
+	ASSERT_EQ(filter_predicate_unregister("even_type"), -ENOENT);
+	ASSERT_FALSE(matches(bytecode, "eth0", 2));
+	ASSERT_FALSE(filter_validate("even_type()", NULL));
+	
+	/* The name gets its id back */
+	ASSERT_EQ(filter_predicate_register("even_type", even_type, FILTER_PREDICATE_ARG_NONE,
+	                                    50, NULL, &id), id);
+	ASSERT_TRUE(matches(bytecode, "eth0", 2));
+	ASSERT_EQ(filter_predicate_unregister_owner(&id), 1);
+	ASSERT_FALSE(matches(bytecode, "eth0", 2));
+	filter_bytecode_free(bytecode);
+}
+
+TEST_SUITE_BEGIN("Filter Predicate")
+	RUN_TEST(filter_predicate_calls);
+	RUN_TEST(filter_predicate_scheduling);
+	RUN_TEST(filter_predicate_unregister);
+TEST_SUITE_END()
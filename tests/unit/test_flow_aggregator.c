@@ -0,0 +1,269 @@
+/* test_flow_aggregator.c - Unit tests for conntrack flow aggregation */
+
+#include "test_framework.h"
+#include "flow_aggregator.h"
+#include "event_processor.h"
+#include "nlmon_nl_netfilter.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+
+#define SEC 1000000000ULL
+
+struct collected {
+	struct flow_summary summaries[16];
+	size_t count;
+};
+
+static void collect(const struct flow_summary *summary, void *ctx)
+{
+	struct collected *c = ctx;
+	
+	if (c->count < 16)
+		c->summaries[c->count] = *summary;
+	c->count++;
+}
+
+static const struct flow_summary *find(const struct collected *c, uint16_t src_port)
+{
+	size_t i;
+	
+	for (i = 0; i < c->count && i < 16; i++)
+		if (c->summaries[i].src_port == src_port)
+			return &c->summaries[i];
+	return NULL;
+}
+
+static bool pass_port_22(struct nlmon_event *event, void *ctx)
+{
+	return event->netlink.data.conntrack->dst_port == 22;
+}
+
+/* Conntrack event of a flow from 10.0.0.1 to 10.0.0.2 */
+static void make_event(struct nlmon_event *event, struct nlmon_ct_info *ct, uint8_t type,
+                       bool create, uint16_t sport, uint16_t dport, uint64_t ts)
+{
+	memset(event, 0, sizeof(*event));
+	memset(ct, 0, sizeof(*ct));
+	ct->protocol = IPPROTO_TCP;
+	strcpy(ct->src_addr, "10.0.0.1");
+	strcpy(ct->dst_addr, "10.0.0.2");
+	ct->src_port = sport;
+	ct->dst_port = dport;
+	event->timestamp = ts;
+	event->netlink.protocol = NETLINK_NETFILTER;
+	event->netlink.msg_type = (NFNL_SUBSYS_CTNETLINK << 8) | type;
+	event->netlink.msg_flags = create ? NLM_F_CREATE | NLM_F_EXCL : 0;
+	event->netlink.data.conntrack = ct;
+}
+
+TEST(flow_summaries_per_tuple)
+{
+	struct flow_aggregator_config config = { .interval = 10, .emit = collect };
+	struct flow_aggregator_stats stats;
+	const struct flow_summary *s;
+	struct flow_aggregator *agg;
+	struct collected c;
+	struct nlmon_event event;
+	struct nlmon_ct_info ct;
+	
+	memset(&c, 0, sizeof(c));
+	config.emit_ctx = &c;
+	agg = flow_aggregator_create(&config);
+	ASSERT_NOT_NULL(agg);
+	
+	/* One flow created, updated and destroyed inside an interval */
+	make_event(&event, &ct, IPCTNL_MSG_CT_NEW, true, 40000, 443, 100 * SEC);
+	ASSERT_FALSE(flow_aggregator_process(agg, &event));
+	make_event(&event, &ct, IPCTNL_MSG_CT_NEW, false, 40000, 443, 102 * SEC);
+	ct.packets_orig = 10;
+	ct.bytes_orig = 1000;
+	ct.packets_reply = 8;
+	ct.bytes_reply = 4000;
+	ASSERT_FALSE(flow_aggregator_process(agg, &event));
+	make_event(&event, &ct, IPCTNL_MSG_CT_DELETE, false, 40000, 443, 105 * SEC);
+	ct.packets_orig = 15;
+	ct.bytes_orig = 1500;
+	ct.packets_reply = 12;
+	ct.bytes_reply = 6000;
+	ASSERT_FALSE(flow_aggregator_process(agg, &event));
+	
+	/* Another flow, still open */
+	make_event(&event, &ct, IPCTNL_MSG_CT_NEW, true, 40001, 443, 106 * SEC);
+	ASSERT_FALSE(flow_aggregator_process(agg, &event));
+	
+	/* Other events pass untouched */
+	memset(&event, 0, sizeof(event));
+	event.netlink.protocol = NETLINK_ROUTE;
+	event.message_type = RTM_NEWLINK;
+	ASSERT_TRUE(flow_aggregator_process(agg, &event));
+	
+	/* Nothing before the interval is over */
+	ASSERT_EQ(flow_aggregator_tick(agg, 109 * SEC), 0);
+	ASSERT_EQ(c.count, 0);
+	ASSERT_EQ(flow_aggregator_tick(agg, 110 * SEC), 2);
+	ASSERT_EQ(c.count, 2);
+	
+	s = find(&c, 40000);
+	ASSERT_NOT_NULL(s);
+	ASSERT_EQ(s->interval_start, 100 * SEC);
+	ASSERT_EQ(s->interval_end, 110 * SEC);
+	ASSERT_EQ(s->first_event, 100 * SEC);
+	ASSERT_EQ(s->last_event, 105 * SEC);
+	ASSERT_EQ(s->events, 3);
+	ASSERT_EQ(s->flows_new, 1);
+	ASSERT_EQ(s->flows_destroyed, 1);
+	ASSERT_EQ(s->packets_orig, 15);
+	ASSERT_EQ(s->bytes_orig, 1500);
+	ASSERT_EQ(s->packets_reply, 12);
+	ASSERT_EQ(s->bytes_reply, 6000);
+	ASSERT_EQ(s->duration_total_ns, 5 * SEC);
+	ASSERT_EQ(s->duration_max_ns, 5 * SEC);
+	ASSERT_STR_EQ(s->src_addr, "10.0.0.1");
+	ASSERT_EQ(s->dst_port, 443);
+	ASSERT_EQ(s->family, AF_INET);
+	
+	s = find(&c, 40001);
+	ASSERT_NOT_NULL(s);
+	ASSERT_EQ(s->flows_new, 1);
+	ASSERT_EQ(s->flows_destroyed, 0);
+	
+	flow_aggregator_get_stats(agg, &stats);
+	ASSERT_EQ(stats.events_folded, 4);
+	ASSERT_EQ(stats.events_passed, 0);
+	ASSERT_EQ(stats.summaries_emitted, 2);
+	ASSERT_EQ(stats.intervals, 1);
+	ASSERT_EQ(stats.summaries, 0);
+	
+	flow_aggregator_destroy(agg);
+}
+
+TEST(flow_counters_across_intervals)
+{
+	struct flow_aggregator_config config = { .interval = 10, .emit = collect };
+	struct flow_aggregator *agg;
+	struct collected c;
+	struct nlmon_event event;
+	struct nlmon_ct_info ct;
+	
+	memset(&c, 0, sizeof(c));
+	config.emit_ctx = &c;
+	agg = flow_aggregator_create(&config);
+	
+	make_event(&event, &ct, IPCTNL_MSG_CT_NEW, true, 40000, 443, 100 * SEC);
+	flow_aggregator_process(agg, &event);
+	make_event(&event, &ct, IPCTNL_MSG_CT_NEW, false, 40000, 443, 105 * SEC);
+	ct.packets_orig = 10;
+	ct.bytes_orig = 1000;
+	flow_aggregator_process(agg, &event);
+	
+	/* An event of the next interval finishes this one */
+	make_event(&event, &ct, IPCTNL_MSG_CT_DELETE, false, 40000, 443, 125 * SEC);
+	ct.packets_orig = 25;
+	ct.bytes_orig = 2500;
+	flow_aggregator_process(agg, &event);
+	ASSERT_EQ(c.count, 1);
+	ASSERT_EQ(c.summaries[0].packets_orig, 10);
+	ASSERT_EQ(c.summaries[0].flows_destroyed, 0);
+	
+	/* Only the growth since the last event counts */
+	ASSERT_EQ(flow_aggregator_flush(agg), 1);
+	ASSERT_EQ(c.count, 2);
+	ASSERT_EQ(c.summaries[1].interval_start, 120 * SEC);
+	ASSERT_EQ(c.summaries[1].packets_orig, 15);
+	ASSERT_EQ(c.summaries[1].bytes_orig, 1500);
+	ASSERT_EQ(c.summaries[1].flows_new, 0);
+	ASSERT_EQ(c.summaries[1].flows_destroyed, 1);
+	ASSERT_EQ(c.summaries[1].duration_max_ns, 25 * SEC);
+	
+	ASSERT_EQ(flow_aggregator_flush(agg), 0);
+	
+	flow_aggregator_destroy(agg);
+}
+
+TEST(flow_hosts_key_and_passthrough)
+{
+	struct flow_aggregator_config config = {
+		.interval = 60,
+		.key = FLOW_KEY_HOSTS,
+		.emit = collect,
+		.passthrough = pass_port_22,
+	};
+	struct flow_aggregator_stats stats;
+	struct flow_aggregator *agg;
+	struct collected c;
+	struct nlmon_event event;
+	struct nlmon_ct_info ct;
+	uint16_t port;
+	
+	memset(&c, 0, sizeof(c));
+	config.emit_ctx = &c;
+	agg = flow_aggregator_create(&config);
+	
+	for (port = 1000; port < 1100; port++) {
+		make_event(&event, &ct, IPCTNL_MSG_CT_NEW, true, port, 80, 60 * SEC + port);
+		ASSERT_FALSE(flow_aggregator_process(agg, &event));
+	}
+	make_event(&event, &ct, IPCTNL_MSG_CT_NEW, true, 2000, 22, 61 * SEC);
+	ASSERT_TRUE(flow_aggregator_process(agg, &event));
+	
+	/* Ports are rolled up into one summary of the two hosts */
+	ASSERT_EQ(flow_aggregator_flush(agg), 1);
+	ASSERT_EQ(c.summaries[0].events, 101);
+	ASSERT_EQ(c.summaries[0].flows_new, 101);
+	ASSERT_EQ(c.summaries[0].src_port, 0);
+	ASSERT_EQ(c.summaries[0].dst_port, 0);
+	ASSERT_STR_EQ(c.summaries[0].dst_addr, "10.0.0.2");
+	
+	flow_aggregator_get_stats(agg, &stats);
+	ASSERT_EQ(stats.events_folded, 101);
+	ASSERT_EQ(stats.events_passed, 1);
+	
+	flow_aggregator_destroy(agg);
+}
+
+TEST(flow_summaries_overflow)
+{
+	struct flow_aggregator_config config = { .interval = 60, .max_summaries = 4, .emit = collect };
+	struct flow_aggregator_stats stats;
+	const struct flow_summary *s;
+	struct flow_aggregator *agg;
+	struct collected c;
+	struct nlmon_event event;
+	struct nlmon_ct_info ct;
+	uint16_t port;
+	
+	memset(&c, 0, sizeof(c));
+	config.emit_ctx = &c;
+	agg = flow_aggregator_create(&config);
+	
+	for (port = 1; port <= 10; port++) {
+		make_event(&event, &ct, IPCTNL_MSG_CT_NEW, true, port, 80, 60 * SEC);
+		flow_aggregator_process(agg, &event);
+	}
+	
+	/* Four summaries, the other six flows in the overflow one */
+	ASSERT_EQ(flow_aggregator_flush(agg), 5);
+	s = find(&c, 0);
+	ASSERT_NOT_NULL(s);
+	ASSERT_EQ(s->family, 0);
+	ASSERT_EQ(s->events, 6);
+	ASSERT_STR_EQ(s->src_addr, "");
+	
+	flow_aggregator_get_stats(agg, &stats);
+	ASSERT_EQ(stats.overflowed, 6);
+	
+	flow_aggregator_destroy(agg);
+}
+
+TEST_SUITE_BEGIN("Flow Aggregator")
+	RUN_TEST(flow_summaries_per_tuple);
+	RUN_TEST(flow_counters_across_intervals);
+	RUN_TEST(flow_hosts_key_and_passthrough);
+	RUN_TEST(flow_summaries_overflow);
+TEST_SUITE_END()
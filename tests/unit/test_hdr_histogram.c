@@ -0,0 +1,171 @@
+/* test_hdr_histogram.c - Unit tests for log-linear histograms */
+
+#include "test_framework.h"
+#include "hdr_histogram.h"
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+
+TEST(hdr_histogram_bucket_keys)
+{
+	struct hdr_histogram *h = hdr_histogram_create(1);
+	uint64_t count;
+	int key = HDR_HISTOGRAM_FIRST_KEY;
+	
+	ASSERT_NOT_NULL(h);
+	ASSERT_NULL(hdr_histogram_create(HDR_HISTOGRAM_MAX_SCHEMA + 1));
+	
+	/* Schema 1 buckets end at 1, sqrt(2), 2, ... and include their bound */
+	hdr_histogram_record(h, 1.0);
+	hdr_histogram_record(h, 1.2);
+	hdr_histogram_record(h, 1.5);
+	hdr_histogram_record(h, 2.0);
+	hdr_histogram_record(h, 0.0);
+	hdr_histogram_record(h, -3.0);
+	hdr_histogram_record(h, NAN);
+	
+	ASSERT_EQ(hdr_histogram_count(h), 6);
+	ASSERT_EQ(hdr_histogram_zero_count(h), 2);
+	ASSERT_FLOAT_EQ(hdr_histogram_sum(h), 2.7, 1e-9);
+	ASSERT_FLOAT_EQ(hdr_histogram_min(h), -3.0, 0);
+	ASSERT_FLOAT_EQ(hdr_histogram_max(h), 2.0, 0);
+	
+	ASSERT_TRUE(hdr_histogram_next_bucket(h, &key, &count));
+	ASSERT_EQ(key, 0);
+	ASSERT_EQ(count, 1);
+	ASSERT_TRUE(hdr_histogram_next_bucket(h, &key, &count));
+	ASSERT_EQ(key, 1);
+	ASSERT_EQ(count, 1);
+	ASSERT_TRUE(hdr_histogram_next_bucket(h, &key, &count));
+	ASSERT_EQ(key, 2);
+	ASSERT_EQ(count, 2);
+	ASSERT_FALSE(hdr_histogram_next_bucket(h, &key, &count));
+	
+	ASSERT_FLOAT_EQ(hdr_histogram_bucket_upper(1, 0), 1.0, 0);
+	ASSERT_FLOAT_EQ(hdr_histogram_bucket_upper(1, 1), sqrt(2.0), 1e-12);
+	ASSERT_FLOAT_EQ(hdr_histogram_bucket_upper(1, -2), 0.5, 0);
+	
+	ASSERT_EQ(hdr_histogram_count_at_most(h, 1.0), 3);
+	ASSERT_EQ(hdr_histogram_count_at_most(h, 1.9), 4);
+	ASSERT_EQ(hdr_histogram_count_at_most(h, INFINITY), 6);
+	
+	hdr_histogram_reset(h);
+	ASSERT_EQ(hdr_histogram_count(h), 0);
+	ASSERT_TRUE(isnan(hdr_histogram_quantile(h, 0.5)));
+	key = HDR_HISTOGRAM_FIRST_KEY;
+	ASSERT_FALSE(hdr_histogram_next_bucket(h, &key, &count));
+	
+	hdr_histogram_destroy(h);
+}
+
+TEST(hdr_histogram_merge)
+{
+	struct hdr_histogram *fine = hdr_histogram_create(2);
+	struct hdr_histogram *coarse = hdr_histogram_create(1);
+	uint64_t count;
+	int key = HDR_HISTOGRAM_FIRST_KEY;
+	
+	ASSERT_NOT_NULL(fine);
+	ASSERT_NOT_NULL(coarse);
+	
+	hdr_histogram_record(fine, 1.1);
+	hdr_histogram_record(fine, 1.3);
+	hdr_histogram_record(fine, 0.0);
+	hdr_histogram_record(coarse, 4.0);
+	
+	/* Schema 2 buckets (1, 1.19] and (1.19, 1.41] both fall in (1, 1.41] */
+	hdr_histogram_merge(coarse, fine);
+	ASSERT_EQ(hdr_histogram_count(coarse), 4);
+	ASSERT_EQ(hdr_histogram_zero_count(coarse), 1);
+	ASSERT_FLOAT_EQ(hdr_histogram_sum(coarse), 6.4, 1e-9);
+	ASSERT_FLOAT_EQ(hdr_histogram_min(coarse), 0.0, 0);
+	ASSERT_FLOAT_EQ(hdr_histogram_max(coarse), 4.0, 0);
+	
+	ASSERT_TRUE(hdr_histogram_next_bucket(coarse, &key, &count));
+	ASSERT_EQ(key, 1);
+	ASSERT_EQ(count, 2);
+	ASSERT_TRUE(hdr_histogram_next_bucket(coarse, &key, &count));
+	ASSERT_EQ(key, 4);
+	ASSERT_EQ(count, 1);
+	ASSERT_FALSE(hdr_histogram_next_bucket(coarse, &key, &count));
+	
+	hdr_histogram_destroy(fine);
+	hdr_histogram_destroy(coarse);
+}
+
+TEST(hdr_histogram_quantile_precision)
+{
+	struct hdr_histogram *h = hdr_histogram_create(HDR_HISTOGRAM_DEFAULT_SCHEMA);
+	double expected, p;
+	
+	ASSERT_NOT_NULL(h);
+	
+	/* Latencies from 1 us to 1 s, evenly spread */
+	for (int i = 1; i <= 1000000; i++)
+		hdr_histogram_record(h, i * 1e-6);
+	
+	/* Within the 2^(1/8) bucket growth of the true quantile */
+	expected = 0.999;
+	p = hdr_histogram_quantile(h, 0.999);
+	ASSERT_TRUE(fabs(p - expected) / expected < 0.09);
+	
+	expected = 0.5;
+	p = hdr_histogram_quantile(h, 0.5);
+	ASSERT_TRUE(fabs(p - expected) / expected < 0.09);
+	
+	ASSERT_FLOAT_EQ(hdr_histogram_quantile(h, 0), 1e-6, 1e-12);
+	ASSERT_FLOAT_EQ(hdr_histogram_quantile(h, 1), 1.0, 1e-12);
+	
+	hdr_histogram_destroy(h);
+	
+	/* A finer schema narrows the error */
+	h = hdr_histogram_create(HDR_HISTOGRAM_MAX_SCHEMA);
+	ASSERT_NOT_NULL(h);
+	for (int i = 1; i <= 100000; i++)
+		hdr_histogram_record(h, i);
+	p = hdr_histogram_quantile(h, 0.999);
+	ASSERT_TRUE(fabs(p - 99900.0) / 99900.0 < 0.003);
+	hdr_histogram_destroy(h);
+}
+
+static void *record_thread(void *arg)
+{
+	struct hdr_histogram *h = arg;
+	
+	for (int i = 0; i < 100000; i++)
+		hdr_histogram_record(h, 0.001 * (i % 100 + 1));
+	
+	return NULL;
+}
+
+TEST(hdr_histogram_concurrent_record)
+{
+	struct hdr_histogram *h = hdr_histogram_create(HDR_HISTOGRAM_DEFAULT_SCHEMA);
+	pthread_t threads[8];
+	uint64_t total = 0, count;
+	int key = HDR_HISTOGRAM_FIRST_KEY;
+	
+	ASSERT_NOT_NULL(h);
+	
+	for (int i = 0; i < 8; i++)
+		ASSERT_EQ(pthread_create(&threads[i], NULL, record_thread, h), 0);
+	for (int i = 0; i < 8; i++)
+		pthread_join(threads[i], NULL);
+	
+	ASSERT_EQ(hdr_histogram_count(h), 800000);
+	while (hdr_histogram_next_bucket(h, &key, &count))
+		total += count;
+	ASSERT_EQ(total, 800000);
+	ASSERT_FLOAT_EQ(hdr_histogram_sum(h), 8 * 1000 * 5.05, 1e-3);
+	ASSERT_FLOAT_EQ(hdr_histogram_min(h), 0.001, 1e-12);
+	ASSERT_FLOAT_EQ(hdr_histogram_max(h), 0.1, 1e-12);
+	
+	hdr_histogram_destroy(h);
+}
+
+TEST_SUITE_BEGIN("HDR Histogram")
+	RUN_TEST(hdr_histogram_bucket_keys);
+	RUN_TEST(hdr_histogram_merge);
+	RUN_TEST(hdr_histogram_quantile_precision);
+	RUN_TEST(hdr_histogram_concurrent_record);
+TEST_SUITE_END()
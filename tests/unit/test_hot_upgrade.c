@@ -0,0 +1,302 @@
+/* test_hot_upgrade.c - Unit tests for socket handoff and state transfer */
+
+#include "test_framework.h"
+#include "hot_upgrade.h"
+#include "fib_mirror.h"
+#include "state_mirror.h"
+#include "nlmon_netlink.h"
+#include "nlmon_nl_route.h"
+#include "nlmon_nl_netfilter.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+#include <netlink/socket.h>
+
+/* Ask for loopback, the reply is one datagram */
+static int request_link(int sock)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct ifinfomsg ifi;
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_type = RTM_GETLINK;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST;
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = 1;
+	return send(sock, &req, sizeof(req), 0) == sizeof(req) ? 0 : -1;
+}
+
+static int readable(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	return poll(&pfd, 1, 100) == 1;
+}
+
+/* Send @up through a socket pair and receive it on the other end */
+static struct nlmon_upgrade *round_trip(const struct nlmon_upgrade *up)
+{
+	struct nlmon_upgrade *out = NULL;
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		return NULL;
+	if (nlmon_upgrade_send(sv[0], up) == 0)
+		nlmon_upgrade_recv(sv[1], &out);
+	close(sv[0]);
+	close(sv[1]);
+	return out;
+}
+
+TEST(upgrade_sections)
+{
+	struct nlmon_upgrade *up = nlmon_upgrade_create();
+	struct nlmon_upgrade *in;
+	uint32_t records[3] = { 1, 2, 3 };
+	const uint32_t *got;
+	const char *filter;
+	size_t len, count;
+
+	ASSERT_NOT_NULL(up);
+	ASSERT_EQ(nlmon_upgrade_add_section(up, NLMON_UPGRADE_SEC_FILTER, "link", 5), 0);
+	ASSERT_EQ(nlmon_upgrade_add_section(up, NLMON_UPGRADE_SEC_FILTER, "addr", 5), -EEXIST);
+	ASSERT_EQ(nlmon_upgrade_add_section(up, NLMON_UPGRADE_SEC_CONFIG, NULL, 0), 0);
+	ASSERT_EQ(nlmon_upgrade_add_records(up, NLMON_UPGRADE_SEC_EVENT_LOG, records,
+	                                    sizeof(records[0]), 3), 0);
+
+	in = round_trip(up);
+	ASSERT_NOT_NULL(in);
+
+	filter = nlmon_upgrade_get_section(in, NLMON_UPGRADE_SEC_FILTER, &len);
+	ASSERT_NOT_NULL(filter);
+	ASSERT_EQ(len, 5);
+	ASSERT_STR_EQ(filter, "link");
+
+	ASSERT_NOT_NULL(nlmon_upgrade_get_section(in, NLMON_UPGRADE_SEC_CONFIG, &len));
+	ASSERT_EQ(len, 0);
+	ASSERT_NULL(nlmon_upgrade_get_section(in, NLMON_UPGRADE_SEC_CT_MIRROR, &len));
+
+	got = nlmon_upgrade_get_records(in, NLMON_UPGRADE_SEC_EVENT_LOG, sizeof(uint32_t), &count);
+	ASSERT_NOT_NULL(got);
+	ASSERT_EQ(count, 3);
+	ASSERT_EQ(got[2], 3);
+
+	/* Another layout gets nothing */
+	ASSERT_NULL(nlmon_upgrade_get_records(in, NLMON_UPGRADE_SEC_EVENT_LOG, sizeof(uint64_t),
+	                                      &count));
+	ASSERT_EQ(count, 0);
+
+	nlmon_upgrade_destroy(in);
+	nlmon_upgrade_destroy(up);
+}
+
+TEST(upgrade_fd_handoff)
+{
+	struct nlmon_upgrade *up = nlmon_upgrade_create();
+	struct nlmon_nl_manager *mgr;
+	struct nlmon_upgrade *in;
+	char buf[4096];
+	int sock, fd;
+
+	ASSERT_NOT_NULL(up);
+	sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+	ASSERT_TRUE(sock >= 0);
+	{
+		struct sockaddr_nl local = { .nl_family = AF_NETLINK };
+
+		ASSERT_EQ(bind(sock, (struct sockaddr *)&local, sizeof(local)), 0);
+	}
+
+	/* A reply the old process never read */
+	ASSERT_EQ(request_link(sock), 0);
+	ASSERT_TRUE(readable(sock));
+
+	ASSERT_EQ(nlmon_upgrade_add_fd(up, NLMON_UPGRADE_FD_NL_ROUTE, sock), 0);
+	ASSERT_EQ(nlmon_upgrade_add_fd(up, NLMON_UPGRADE_FD_NL_ROUTE, sock), -EEXIST);
+
+	in = round_trip(up);
+	ASSERT_NOT_NULL(in);
+	nlmon_upgrade_destroy(up);
+	close(sock);
+
+	ASSERT_EQ(nlmon_upgrade_take_fd(in, NLMON_UPGRADE_FD_NL_GENERIC), -1);
+	fd = nlmon_upgrade_take_fd(in, NLMON_UPGRADE_FD_NL_ROUTE);
+	ASSERT_TRUE(fd >= 0);
+	ASSERT_EQ(nlmon_upgrade_take_fd(in, NLMON_UPGRADE_FD_NL_ROUTE), -1);
+	nlmon_upgrade_destroy(in);
+
+	/* The manager takes the socket over instead of opening one */
+	mgr = nlmon_nl_manager_init();
+	ASSERT_NOT_NULL(mgr);
+	ASSERT_EQ(nlmon_nl_adopt_socket(mgr, NETLINK_ROUTE, fd), 0);
+	ASSERT_EQ(nlmon_nl_enable_route(mgr), 0);
+	ASSERT_EQ(nlmon_nl_get_route_fd(mgr), fd);
+	ASSERT_EQ(nlmon_nl_adopt_socket(mgr, NETLINK_ROUTE, fd), -EALREADY);
+
+	/* With what the kernel queued before the handoff */
+	ASSERT_TRUE(readable(fd));
+	ASSERT_TRUE(recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0);
+
+	nlmon_nl_manager_destroy(mgr);
+}
+
+TEST(upgrade_adopt_wrong_protocol)
+{
+	struct nlmon_nl_manager *mgr = nlmon_nl_manager_init();
+	int sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+	struct sockaddr_nl local = { .nl_family = AF_NETLINK };
+
+	ASSERT_NOT_NULL(mgr);
+	ASSERT_TRUE(sock >= 0);
+	ASSERT_EQ(bind(sock, (struct sockaddr *)&local, sizeof(local)), 0);
+
+	/* Not usable for NETLINK_ROUTE, a new socket is opened instead */
+	ASSERT_EQ(nlmon_nl_adopt_socket(mgr, NETLINK_ROUTE, sock), 0);
+	ASSERT_EQ(nlmon_nl_enable_route(mgr), 0);
+	ASSERT_TRUE(nlmon_nl_get_route_fd(mgr) >= 0);
+	ASSERT_EQ(mgr->adopt_fds[0], -1);
+
+	nlmon_nl_manager_destroy(mgr);
+}
+
+static bool first_neigh(const struct neigh_mirror_entry *entry, void *ctx)
+{
+	*(struct neigh_mirror_entry *)ctx = *entry;
+	return false;
+}
+
+static bool count_route(const struct fib_mirror_route *route, void *ctx)
+{
+	(void)route;
+	(*(int *)ctx)++;
+	return true;
+}
+
+TEST(upgrade_mirrors)
+{
+	struct fib_mirror *fib = fib_mirror_create(0), *fib2 = fib_mirror_create(0);
+	struct neigh_mirror *neigh = neigh_mirror_create(0), *neigh2 = neigh_mirror_create(0);
+	struct ct_mirror *ct = ct_mirror_create(0), *ct2 = ct_mirror_create(0);
+	struct nlmon_route_info route = { .family = AF_INET, .dst_len = 24, .table = 254,
+	                                  .dst = "10.0.0.0", .gateway = "10.0.0.1" };
+	struct nlmon_neigh_info n = { .family = AF_INET, .ifindex = 2, .state = 2,
+	                              .lladdr = { 2, 0, 0, 0, 0, 1 } };
+	struct nlmon_ct_info flow = { .protocol = IPPROTO_TCP, .src_addr = "10.0.0.2",
+	                              .dst_addr = "10.0.0.3", .src_port = 1, .dst_port = 2,
+	                              .bytes_orig = 99 };
+	struct neigh_mirror_entry newest, entry;
+	struct ct_mirror_entry ct_entry;
+	struct fib_mirror_route found;
+	struct nlmon_upgrade *up = nlmon_upgrade_create(), *in;
+	int routes = 0;
+
+	ASSERT_NOT_NULL(up);
+	ASSERT_EQ(fib_mirror_add(fib, &route, 100), 0);
+	route.table = 10;
+	strcpy(route.dst, "192.168.0.0");
+	route.gateway[0] = '\0';
+	ASSERT_EQ(fib_mirror_add(fib, &route, 200), 0);
+
+	strcpy(n.dst, "10.0.0.1");
+	ASSERT_EQ(neigh_mirror_update(neigh, RTM_NEWNEIGH, &n, 300, NULL), 0);
+	strcpy(n.dst, "10.0.0.2");
+	ASSERT_EQ(neigh_mirror_update(neigh, RTM_NEWNEIGH, &n, 400, NULL), 0);
+
+	ASSERT_EQ(ct_mirror_update(ct, IPCTNL_MSG_CT_NEW, &flow, 500), 0);
+
+	ASSERT_EQ(nlmon_upgrade_add_fib(up, fib), 0);
+	ASSERT_EQ(nlmon_upgrade_add_neigh(up, neigh), 0);
+	ASSERT_EQ(nlmon_upgrade_add_ct(up, ct), 0);
+	in = round_trip(up);
+	ASSERT_NOT_NULL(in);
+
+	/* Every table, with the times of the old process */
+	ASSERT_EQ(nlmon_upgrade_restore_fib(in, fib2), 2);
+	ASSERT_EQ(fib_mirror_walk_all(fib2, count_route, &routes), 2);
+	ASSERT_EQ(routes, 2);
+	ASSERT_TRUE(fib_mirror_lookup(fib2, 254, "10.0.0.7", &found));
+	ASSERT_STR_EQ(found.gateway, "10.0.0.1");
+	ASSERT_EQ(found.since, 100);
+
+	/* Same recency order */
+	ASSERT_EQ(nlmon_upgrade_restore_neigh(in, neigh2), 2);
+	neigh_mirror_walk(neigh2, first_neigh, &newest);
+	ASSERT_STR_EQ(newest.dst, "10.0.0.2");
+	ASSERT_TRUE(neigh_mirror_lookup(neigh2, 2, "10.0.0.1", &entry));
+	ASSERT_EQ(entry.first_seen, 300);
+	ASSERT_EQ(entry.lladdr[5], 1);
+
+	ASSERT_EQ(nlmon_upgrade_restore_ct(in, ct2), 1);
+	ASSERT_TRUE(ct_mirror_lookup(ct2, &flow, &ct_entry));
+	ASSERT_EQ(ct_entry.bytes_orig, 99);
+	ASSERT_EQ(ct_entry.updated, 500);
+
+	nlmon_upgrade_destroy(in);
+	nlmon_upgrade_destroy(up);
+	fib_mirror_destroy(fib);
+	fib_mirror_destroy(fib2);
+	neigh_mirror_destroy(neigh);
+	neigh_mirror_destroy(neigh2);
+	ct_mirror_destroy(ct);
+	ct_mirror_destroy(ct2);
+}
+
+TEST(upgrade_exchange)
+{
+	char path[64];
+	struct nlmon_upgrade *up = nlmon_upgrade_create(), *in = NULL;
+	int lfd, old_conn, new_conn;
+
+	ASSERT_NOT_NULL(up);
+	snprintf(path, sizeof(path), "/tmp/nlmon-upgrade-test.%d", (int)getpid());
+	unlink(path);
+
+	/* Nothing running, a fresh start */
+	ASSERT_EQ(nlmon_upgrade_connect(path), -ENOENT);
+
+	lfd = nlmon_upgrade_listen(path);
+	ASSERT_TRUE(lfd >= 0);
+	ASSERT_EQ(nlmon_upgrade_accept(lfd), -EAGAIN);
+
+	new_conn = nlmon_upgrade_connect(path);
+	ASSERT_TRUE(new_conn >= 0);
+	old_conn = nlmon_upgrade_accept(lfd);
+	ASSERT_TRUE(old_conn >= 0);
+
+	ASSERT_EQ(nlmon_upgrade_request(new_conn), 0);
+	ASSERT_EQ(nlmon_upgrade_wait_request(old_conn), 0);
+	ASSERT_EQ(nlmon_upgrade_add_section(up, NLMON_UPGRADE_SEC_FILTER, "x", 2), 0);
+	ASSERT_EQ(nlmon_upgrade_send(old_conn, up), 0);
+	ASSERT_EQ(nlmon_upgrade_recv(new_conn, &in), 0);
+	ASSERT_NOT_NULL(in);
+
+	/* A new process that fails sends why, one that dies sends nothing */
+	ASSERT_EQ(nlmon_upgrade_done(new_conn, -EBUSY), 0);
+	ASSERT_EQ(nlmon_upgrade_wait_done(old_conn), -EBUSY);
+	close(new_conn);
+	ASSERT_EQ(nlmon_upgrade_wait_done(old_conn), -ECONNRESET);
+
+	close(old_conn);
+	close(lfd);
+	unlink(path);
+	nlmon_upgrade_destroy(in);
+	nlmon_upgrade_destroy(up);
+}
+
+TEST_SUITE_BEGIN("Hot Upgrade")
+	RUN_TEST(upgrade_sections);
+	RUN_TEST(upgrade_fd_handoff);
+	RUN_TEST(upgrade_adopt_wrong_protocol);
+	RUN_TEST(upgrade_mirrors);
+	RUN_TEST(upgrade_exchange);
+TEST_SUITE_END()
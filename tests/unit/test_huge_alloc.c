@@ -0,0 +1,126 @@
+/* test_huge_alloc.c - Unit tests for huge page backed allocation */
+
+#include "test_framework.h"
+#include "huge_alloc.h"
+#include "stats_bus.h"
+#include <stdint.h>
+#include <string.h>
+
+#define MB (1024UL * 1024)
+
+TEST(huge_off_uses_calloc)
+{
+	struct huge_alloc_stats stats;
+	unsigned char *ptr;
+	
+	huge_alloc_configure(NULL);
+	ptr = huge_calloc(4, MB, 0, "test");
+	ASSERT_NOT_NULL(ptr);
+	ASSERT_FALSE(huge_alloc_backed(ptr));
+	ASSERT_EQ(ptr[4 * MB - 1], 0);
+	
+	huge_alloc_get_stats(&stats);
+	ASSERT_EQ(stats.regions, 0);
+	huge_free(ptr);
+}
+
+TEST(huge_below_min_size)
+{
+	struct huge_alloc_config config = { .mode = HUGE_ALLOC_THP, .min_size = 8 * MB };
+	struct huge_alloc_stats stats;
+	void *ptr;
+	
+	huge_alloc_configure(&config);
+	ptr = huge_calloc(1, 4 * MB, 0, "test");
+	ASSERT_NOT_NULL(ptr);
+	huge_alloc_get_stats(&stats);
+	ASSERT_EQ(stats.regions, 0);
+	huge_free(ptr);
+	huge_alloc_configure(NULL);
+}
+
+TEST(huge_mapped)
+{
+	struct huge_alloc_config config = { .mode = HUGE_ALLOC_THP, .prefault = true };
+	struct huge_alloc_stats stats;
+	unsigned char *ptr;
+	
+	huge_alloc_configure(&config);
+	ptr = huge_calloc(3, MB, 0, "test");
+	ASSERT_NOT_NULL(ptr);
+	
+	/* Zeroed, writable and aligned for the kernel to back with huge pages */
+	ASSERT_EQ(ptr[0], 0);
+	ASSERT_EQ(ptr[3 * MB - 1], 0);
+	memset(ptr, 0xab, 3 * MB);
+	ASSERT_EQ((uintptr_t)ptr % (2 * MB), 0);
+	
+	/* Rounded up to whole huge pages */
+	huge_alloc_get_stats(&stats);
+	ASSERT_EQ(stats.regions, 1);
+	ASSERT_TRUE(stats.bytes >= 3 * MB);
+	ASSERT_TRUE(stats.thp_bytes + stats.hugetlb_bytes <= stats.bytes);
+	
+	huge_free(ptr);
+	huge_alloc_get_stats(&stats);
+	ASSERT_EQ(stats.regions, 0);
+	ASSERT_EQ(stats.bytes, 0);
+	huge_alloc_configure(NULL);
+}
+
+TEST(huge_forced)
+{
+	struct huge_alloc_stats stats;
+	void *ptr;
+	
+	/* Small and with the backend off, still mapped */
+	huge_alloc_configure(NULL);
+	ptr = huge_calloc(16, 64, HUGE_ALLOC_FORCE, "test");
+	ASSERT_NOT_NULL(ptr);
+	huge_alloc_get_stats(&stats);
+	ASSERT_EQ(stats.regions, 1);
+	huge_free(ptr);
+	
+	huge_alloc_get_stats(&stats);
+	ASSERT_EQ(stats.regions, 0);
+	
+	/* Overflow */
+	ASSERT_NULL(huge_calloc(SIZE_MAX, 2, HUGE_ALLOC_FORCE, "test"));
+	huge_free(NULL);
+}
+
+static void count_region(const struct huge_alloc_region *region, void *ctx)
+{
+	if (strcmp(region->owner, "ring") == 0)
+		(*(int *)ctx)++;
+}
+
+TEST(huge_collect)
+{
+	struct nlmon_stats_snapshot snapshot;
+	int rings = 0;
+	void *ptr;
+	
+	ptr = huge_calloc(1, MB, HUGE_ALLOC_FORCE, "ring");
+	ASSERT_NOT_NULL(ptr);
+	
+	huge_alloc_for_each(count_region, &rings);
+	ASSERT_EQ(rings, 1);
+	
+	memset(&snapshot, 0, sizeof(snapshot));
+	huge_alloc_collect_stats(&snapshot, NULL);
+	ASSERT_TRUE(snapshot.have & STATS_HAVE_HUGEPAGES);
+	ASSERT_EQ(snapshot.hugepages.regions, 1);
+	ASSERT_TRUE(snapshot.hugepages.bytes >= MB);
+	ASSERT_TRUE(snapshot.hugepages.huge_bytes <= snapshot.hugepages.bytes);
+	
+	huge_free(ptr);
+}
+
+TEST_SUITE_BEGIN("Huge Alloc")
+	RUN_TEST(huge_off_uses_calloc);
+	RUN_TEST(huge_below_min_size);
+	RUN_TEST(huge_mapped);
+	RUN_TEST(huge_forced);
+	RUN_TEST(huge_collect);
+TEST_SUITE_END()
@@ -0,0 +1,195 @@
+/* test_interface_detector.c - Unit tests for the interface topology cache */
+
+#include "test_framework.h"
+#include "interface_detector.h"
+#include <string.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+
+struct link_msg {
+	struct nlmsghdr nlh;
+	struct ifinfomsg ifi;
+	char attrs[256];
+};
+
+static struct rtattr *add_attr(struct nlmsghdr *nlh, int type, const void *data, size_t len)
+{
+	struct rtattr *rta = (struct rtattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+	
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	if (data)
+		memcpy(RTA_DATA(rta), data, len);
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+	return rta;
+}
+
+static void end_nest(struct nlmsghdr *nlh, struct rtattr *nest)
+{
+	nest->rta_len = (char *)nlh + nlh->nlmsg_len - (char *)nest;
+}
+
+/* RTM_NEWLINK for an interface of a kind, enslaved to master and
+ * stacked on link when those are not 0 */
+static struct nlmsghdr *build_link(struct link_msg *msg, uint16_t type, int ifindex,
+                                   const char *ifname, const char *kind, int master,
+                                   int link, uint16_t vlan_id)
+{
+	memset(msg, 0, sizeof(*msg));
+	msg->nlh.nlmsg_type = type;
+	msg->nlh.nlmsg_len = NLMSG_LENGTH(sizeof(msg->ifi));
+	msg->ifi.ifi_index = ifindex;
+	
+	add_attr(&msg->nlh, IFLA_IFNAME, ifname, strlen(ifname) + 1);
+	if (master)
+		add_attr(&msg->nlh, IFLA_MASTER, &master, sizeof(master));
+	if (link)
+		add_attr(&msg->nlh, IFLA_LINK, &link, sizeof(link));
+	if (kind) {
+		struct rtattr *linkinfo = add_attr(&msg->nlh, IFLA_LINKINFO, NULL, 0);
+		
+		add_attr(&msg->nlh, IFLA_INFO_KIND, kind, strlen(kind) + 1);
+		if (vlan_id) {
+			struct rtattr *data = add_attr(&msg->nlh, IFLA_INFO_DATA, NULL, 0);
+			
+			add_attr(&msg->nlh, IFLA_VLAN_ID, &vlan_id, sizeof(vlan_id));
+			end_nest(&msg->nlh, data);
+		}
+		end_nest(&msg->nlh, linkinfo);
+	}
+	return &msg->nlh;
+}
+
+TEST(detector_bridge_topology)
+{
+	struct interface_detector *detector = interface_detector_init();
+	struct interface_link info;
+	struct bridge_info bridge;
+	struct link_msg msg;
+	int members[8], children[8], ancestors[8];
+	int parent;
+	
+	ASSERT_NOT_NULL(detector);
+	
+	ASSERT_EQ(interface_detector_update(detector,
+	          build_link(&msg, RTM_NEWLINK, 1, "br0", "bridge", 0, 0, 0)), 1);
+	ASSERT_EQ(interface_detector_update(detector,
+	          build_link(&msg, RTM_NEWLINK, 2, "eth1", NULL, 1, 0, 0)), 1);
+	ASSERT_EQ(interface_detector_update(detector,
+	          build_link(&msg, RTM_NEWLINK, 3, "eth2", NULL, 1, 0, 0)), 1);
+	ASSERT_EQ(interface_detector_update(detector,
+	          build_link(&msg, RTM_NEWLINK, 4, "br0.10", "vlan", 0, 1, 10)), 1);
+	ASSERT_EQ(interface_detector_update(detector,
+	          build_link(&msg, RTM_NEWADDR, 4, "br0.10", NULL, 0, 0, 0)), 0);
+	
+	/* The VLAN is a child of the bridge but not one of its ports */
+	ASSERT_EQ(interface_detector_get_hierarchy(detector, 1, &parent, children, 8), 3);
+	ASSERT_EQ(parent, 0);
+	ASSERT_EQ(interface_detector_get_members(detector, 1, members, 8), 2);
+	ASSERT_TRUE((members[0] == 2 && members[1] == 3) || (members[0] == 3 && members[1] == 2));
+	
+	ASSERT_EQ(interface_detector_get_link(detector, 4, &info), 0);
+	ASSERT_STR_EQ(info.name, "br0.10");
+	ASSERT_EQ(info.type, IFACE_TYPE_VLAN);
+	ASSERT_EQ(info.parent, 1);
+	ASSERT_EQ(info.vlan_id, 10);
+	ASSERT_EQ(interface_detector_get_ancestors(detector, 4, ancestors, 8), 1);
+	ASSERT_EQ(ancestors[0], 1);
+	ASSERT_TRUE(interface_detector_is_under(detector, 2, 1));
+	ASSERT_FALSE(interface_detector_is_under(detector, 1, 2));
+	ASSERT_FALSE(interface_detector_is_under(detector, 1, 1));
+	
+	/* Ports come from the topology rather than the bridge's message */
+	ASSERT_EQ(interface_detector_parse_bridge(detector,
+	          build_link(&msg, RTM_NEWLINK, 1, "br0", "bridge", 0, 0, 0), &bridge), 0);
+	ASSERT_EQ(bridge.num_ports, 2);
+	ASSERT_TRUE(strcmp(bridge.port_names[0], "eth1") == 0 ||
+	            strcmp(bridge.port_names[0], "eth2") == 0);
+	
+	/* Released from the bridge */
+	ASSERT_EQ(interface_detector_update(detector,
+	          build_link(&msg, RTM_NEWLINK, 2, "eth1", NULL, 0, 0, 0)), 1);
+	ASSERT_EQ(interface_detector_get_members(detector, 1, members, 8), 1);
+	ASSERT_EQ(members[0], 3);
+	
+	/* Deleting the bridge orphans what was left on it */
+	ASSERT_EQ(interface_detector_update(detector,
+	          build_link(&msg, RTM_DELLINK, 1, "br0", "bridge", 0, 0, 0)), 1);
+	ASSERT_EQ(interface_detector_get_link(detector, 1, &info), -1);
+	ASSERT_EQ(interface_detector_get_hierarchy(detector, 3, &parent, NULL, 0), 0);
+	ASSERT_EQ(parent, 0);
+	ASSERT_EQ(interface_detector_get_ancestors(detector, 4, NULL, 0), 0);
+	
+	interface_detector_destroy(detector);
+}
+
+TEST(detector_master_seen_late)
+{
+	struct interface_detector *detector = interface_detector_init();
+	struct interface_link info;
+	struct link_msg msg;
+	char name[IFNAMSIZ];
+	int parent;
+	
+	ASSERT_NOT_NULL(detector);
+	
+	/* A slave reported before its bond */
+	interface_detector_update(detector, build_link(&msg, RTM_NEWLINK, 5, "eth5", NULL, 6, 0, 0));
+	ASSERT_EQ(interface_detector_get_hierarchy(detector, 6, &parent, NULL, 0), 0);
+	ASSERT_EQ(parent, -1);
+	ASSERT_EQ(interface_detector_get_members(detector, 6, NULL, 8), 1);
+	ASSERT_EQ(interface_detector_get_link(detector, 6, &info), -1);
+	ASSERT_EQ(interface_detector_get_name(detector, 6, name, sizeof(name)), -1);
+	
+	interface_detector_update(detector, build_link(&msg, RTM_NEWLINK, 6, "bond0", "bond", 0, 0, 0));
+	ASSERT_EQ(interface_detector_get_link(detector, 6, &info), 0);
+	ASSERT_EQ(info.type, IFACE_TYPE_BOND);
+	ASSERT_EQ(info.num_children, 1);
+	
+	/* A parent that was never reported goes with its last child */
+	interface_detector_update(detector, build_link(&msg, RTM_NEWLINK, 7, "eth7", NULL, 8, 0, 0));
+	interface_detector_update(detector, build_link(&msg, RTM_DELLINK, 7, "eth7", NULL, 0, 0, 0));
+	ASSERT_EQ(interface_detector_get_members(detector, 8, NULL, 8), 0);
+	
+	/* Loops from stale events are refused */
+	interface_detector_update(detector, build_link(&msg, RTM_NEWLINK, 6, "bond0", "bond", 5, 0, 0));
+	ASSERT_EQ(interface_detector_get_ancestors(detector, 6, NULL, 0), 0);
+	ASSERT_EQ(interface_detector_get_ancestors(detector, 5, NULL, 0), 1);
+	
+	interface_detector_destroy(detector);
+}
+
+TEST(detector_large_bond)
+{
+	struct interface_detector *detector = interface_detector_init();
+	struct link_msg msg;
+	static int members[3000];
+	char name[IFNAMSIZ];
+	
+	ASSERT_NOT_NULL(detector);
+	
+	interface_detector_update(detector, build_link(&msg, RTM_NEWLINK, 1, "bond0", "bond", 0, 0, 0));
+	for (int i = 2; i < 3002; i++) {
+		snprintf(name, sizeof(name), "eth%d", i);
+		interface_detector_update(detector, build_link(&msg, RTM_NEWLINK, i, name, NULL, 1, 0, 0));
+	}
+	ASSERT_EQ(interface_detector_get_members(detector, 1, members, 3000), 3000);
+	
+	/* Removal from the middle keeps the child list whole */
+	for (int i = 2; i < 3002; i += 2)
+		interface_detector_update(detector, build_link(&msg, RTM_DELLINK, i, "x", NULL, 0, 0, 0));
+	ASSERT_EQ(interface_detector_get_members(detector, 1, members, 3000), 1500);
+	for (int i = 0; i < 1500; i++)
+		ASSERT_TRUE(members[i] % 2 == 1);
+	ASSERT_EQ(interface_detector_get_name(detector, 3001, name, sizeof(name)), 0);
+	ASSERT_STR_EQ(name, "eth3001");
+	
+	interface_detector_destroy(detector);
+}
+
+TEST_SUITE_BEGIN("Interface Detector")
+	RUN_TEST(detector_bridge_topology);
+	RUN_TEST(detector_master_seen_late);
+	RUN_TEST(detector_large_bond);
+TEST_SUITE_END()
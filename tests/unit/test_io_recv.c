@@ -0,0 +1,360 @@
+/* test_io_recv.c - Unit tests for the io_uring multishot receiver */
+
+#include "test_framework.h"
+#include "io_recv.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define MAX_KEPT 32
+
+struct received {
+	int count;
+	int errors;
+	int last_error;
+	int truncated;
+	int source;
+	char data[MAX_KEPT][64];
+	size_t len[MAX_KEPT];
+	struct sockaddr_in from;
+	bool named;
+};
+
+static void keep_datagram(void *ctx, int source, const struct io_recv_msg *msg, int error)
+{
+	struct received *r = ctx;
+	
+	r->source = source;
+	if (error) {
+		r->errors++;
+		r->last_error = error;
+		return;
+	}
+	
+	if (r->count < MAX_KEPT) {
+		size_t n = msg->len < sizeof(r->data[0]) ? msg->len : sizeof(r->data[0]);
+		
+		memcpy(r->data[r->count], msg->data, n);
+		r->len[r->count] = msg->len;
+	}
+	if (msg->truncated)
+		r->truncated++;
+	if (msg->name && msg->namelen >= sizeof(r->from)) {
+		memcpy(&r->from, msg->name, sizeof(r->from));
+		r->named = true;
+	}
+	r->count++;
+}
+
+static struct io_recv *create_recv(unsigned int buffers, size_t size)
+{
+	struct io_recv_config config = {
+		.buffer_count = buffers,
+		.buffer_size = size,
+	};
+	
+	return io_recv_create(&config);
+}
+
+/* Handle completions until @want datagrams arrived or it gives up */
+static void run_until(struct io_recv *rx, struct received *r, int want)
+{
+	for (int i = 0; i < 200 && r->count < want; i++) {
+		if (io_recv_run(rx, false) == 0)
+			usleep(1000);
+	}
+}
+
+static void send_numbered(int fd, int count)
+{
+	char buf[32];
+	
+	for (int i = 0; i < count; i++) {
+		int n = snprintf(buf, sizeof(buf), "datagram %d", i);
+		
+		if (send(fd, buf, (size_t)n, 0) != n)
+			break;
+	}
+}
+
+TEST(datagrams_arrive_in_order)
+{
+	struct received r = { 0 };
+	struct io_recv_stats stats;
+	struct io_recv *rx;
+	char expect[32];
+	int sv[2];
+	
+	rx = create_recv(8, 4096);
+	ASSERT_NOT_NULL(rx);
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM, 0, sv), 0);
+	ASSERT_EQ(io_recv_add(rx, sv[0], 0, keep_datagram, &r), 0);
+	
+	send_numbered(sv[1], 20);
+	run_until(rx, &r, 20);
+	
+	ASSERT_EQ(r.count, 20);
+	ASSERT_EQ(r.errors, 0);
+	for (int i = 0; i < 20; i++) {
+		snprintf(expect, sizeof(expect), "datagram %d", i);
+		ASSERT_EQ(r.len[i], strlen(expect));
+		ASSERT_TRUE(memcmp(r.data[i], expect, r.len[i]) == 0);
+	}
+	
+	io_recv_get_stats(rx, &stats);
+	ASSERT_EQ(stats.datagrams, 20);
+	ASSERT_EQ(stats.sources, 1);
+	ASSERT_EQ(stats.buffers, 8);
+	ASSERT_EQ(stats.errors, 0);
+	
+	io_recv_destroy(rx);
+	close(sv[0]);
+	close(sv[1]);
+}
+
+TEST(dry_buffer_ring_is_rearmed)
+{
+	struct received r = { 0 };
+	struct io_recv_stats stats;
+	struct io_recv *rx;
+	int sv[2];
+	
+	/* Two buffers for ten queued datagrams */
+	rx = create_recv(2, 4096);
+	ASSERT_NOT_NULL(rx);
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM, 0, sv), 0);
+	ASSERT_EQ(io_recv_add(rx, sv[0], 0, keep_datagram, &r), 0);
+	
+	send_numbered(sv[1], 10);
+	run_until(rx, &r, 10);
+	
+	/* Running dry is not an error, nothing was dropped */
+	ASSERT_EQ(r.count, 10);
+	ASSERT_EQ(r.errors, 0);
+	ASSERT_TRUE(memcmp(r.data[9], "datagram 9", 10) == 0);
+	io_recv_get_stats(rx, &stats);
+	ASSERT_TRUE(stats.rearms > 0);
+	ASSERT_EQ(stats.errors, 0);
+	
+	io_recv_destroy(rx);
+	close(sv[0]);
+	close(sv[1]);
+}
+
+TEST(oversize_datagram_is_truncated)
+{
+	struct received r = { 0 };
+	struct io_recv_stats stats;
+	struct io_recv *rx;
+	char big[2048];
+	int sv[2];
+	
+	rx = create_recv(4, 512);
+	ASSERT_NOT_NULL(rx);
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM, 0, sv), 0);
+	ASSERT_EQ(io_recv_add(rx, sv[0], 0, keep_datagram, &r), 0);
+	
+	memset(big, 'x', sizeof(big));
+	ASSERT_EQ(send(sv[1], big, sizeof(big), 0), (ssize_t)sizeof(big));
+	send_numbered(sv[1], 1);
+	run_until(rx, &r, 2);
+	
+	ASSERT_EQ(r.count, 2);
+	ASSERT_EQ(r.truncated, 1);
+	ASSERT_TRUE(r.len[0] < sizeof(big));
+	ASSERT_TRUE(memcmp(r.data[1], "datagram 0", 10) == 0);
+	io_recv_get_stats(rx, &stats);
+	ASSERT_EQ(stats.truncated, 1);
+	
+	io_recv_destroy(rx);
+	close(sv[0]);
+	close(sv[1]);
+}
+
+TEST(source_address_is_reported)
+{
+	struct received r = { 0 };
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	struct sockaddr_in local;
+	socklen_t len = sizeof(addr);
+	struct io_recv *rx;
+	int rfd, sfd;
+	
+	rx = create_recv(4, 4096);
+	ASSERT_NOT_NULL(rx);
+	
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	rfd = socket(AF_INET, SOCK_DGRAM, 0);
+	sfd = socket(AF_INET, SOCK_DGRAM, 0);
+	ASSERT_TRUE(rfd >= 0 && sfd >= 0);
+	ASSERT_EQ(bind(rfd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+	ASSERT_EQ(getsockname(rfd, (struct sockaddr *)&addr, &len), 0);
+	ASSERT_EQ(connect(sfd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+	len = sizeof(local);
+	ASSERT_EQ(getsockname(sfd, (struct sockaddr *)&local, &len), 0);
+	
+	ASSERT_EQ(io_recv_add(rx, rfd, sizeof(struct sockaddr_in), keep_datagram, &r), 0);
+	send_numbered(sfd, 1);
+	run_until(rx, &r, 1);
+	
+	ASSERT_EQ(r.count, 1);
+	ASSERT_TRUE(r.named);
+	ASSERT_EQ(r.from.sin_port, local.sin_port);
+	ASSERT_EQ(r.from.sin_addr.s_addr, htonl(INADDR_LOOPBACK));
+	
+	io_recv_destroy(rx);
+	close(rfd);
+	close(sfd);
+}
+
+TEST(set_fd_moves_the_source)
+{
+	struct received r = { 0 };
+	struct io_recv *rx;
+	int a[2], b[2];
+	int source;
+	
+	rx = create_recv(4, 4096);
+	ASSERT_NOT_NULL(rx);
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM, 0, a), 0);
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM, 0, b), 0);
+	
+	source = io_recv_add(rx, a[0], 0, keep_datagram, &r);
+	ASSERT_EQ(source, 0);
+	send_numbered(a[1], 1);
+	run_until(rx, &r, 1);
+	ASSERT_EQ(r.count, 1);
+	
+	/* As a reconnect does, the old socket is no longer read */
+	ASSERT_EQ(io_recv_set_fd(rx, source, b[0]), 0);
+	ASSERT_EQ(send(a[1], "old", 3, 0), 3);
+	ASSERT_EQ(send(b[1], "new", 3, 0), 3);
+	run_until(rx, &r, 3);
+	
+	ASSERT_EQ(r.count, 2);
+	ASSERT_EQ(r.source, source);
+	ASSERT_TRUE(memcmp(r.data[1], "new", 3) == 0);
+	ASSERT_EQ(r.errors, 0);
+	
+	/* Stopped sources stay quiet */
+	ASSERT_EQ(io_recv_set_fd(rx, source, -1), 0);
+	ASSERT_EQ(send(b[1], "gone", 4, 0), 4);
+	run_until(rx, &r, 3);
+	ASSERT_EQ(r.count, 2);
+	
+	ASSERT_EQ(io_recv_set_fd(rx, 5, b[0]), -EINVAL);
+	
+	io_recv_destroy(rx);
+	close(a[0]);
+	close(a[1]);
+	close(b[0]);
+	close(b[1]);
+}
+
+struct waiter {
+	struct io_recv *rx;
+	atomic_int stop;
+	atomic_int rounds;
+};
+
+static void *wait_thread(void *arg)
+{
+	struct waiter *w = arg;
+	
+	while (!atomic_load(&w->stop)) {
+		io_recv_run(w->rx, true);
+		atomic_fetch_add(&w->rounds, 1);
+	}
+	return NULL;
+}
+
+TEST(wake_unblocks_a_waiting_run)
+{
+	struct received r = { 0 };
+	struct waiter w = { 0 };
+	pthread_t thread;
+	int sv[2];
+	
+	w.rx = create_recv(4, 4096);
+	ASSERT_NOT_NULL(w.rx);
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM, 0, sv), 0);
+	ASSERT_EQ(io_recv_add(w.rx, sv[0], 0, keep_datagram, &r), 0);
+	ASSERT_EQ(pthread_create(&thread, NULL, wait_thread, &w), 0);
+	
+	/* A datagram ends the wait, then the thread blocks again */
+	send_numbered(sv[1], 1);
+	for (int i = 0; i < 1000 && r.count < 1; i++)
+		usleep(1000);
+	ASSERT_EQ(r.count, 1);
+	
+	atomic_store(&w.stop, 1);
+	io_recv_wake(w.rx);
+	pthread_join(thread, NULL);
+	ASSERT_TRUE(atomic_load(&w.rounds) >= 1);
+	
+	io_recv_destroy(w.rx);
+	close(sv[0]);
+	close(sv[1]);
+}
+
+TEST(socket_drops_report_enobufs)
+{
+	struct received r = { 0 };
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	socklen_t len = sizeof(addr);
+	struct io_recv *rx;
+	char payload[1024];
+	int rfd, sfd, size = 1;
+	
+	rx = create_recv(2, 4096);
+	ASSERT_NOT_NULL(rx);
+	
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	rfd = socket(AF_INET, SOCK_DGRAM, 0);
+	sfd = socket(AF_INET, SOCK_DGRAM, 0);
+	ASSERT_TRUE(rfd >= 0 && sfd >= 0);
+	setsockopt(rfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	ASSERT_EQ(bind(rfd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+	ASSERT_EQ(getsockname(rfd, (struct sockaddr *)&addr, &len), 0);
+	ASSERT_EQ(connect(sfd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+	
+	/* Arm, then overflow the smallest receive buffer */
+	ASSERT_EQ(io_recv_add(rx, rfd, 0, keep_datagram, &r), 0);
+	io_recv_run(rx, false);
+	memset(payload, 'y', sizeof(payload));
+	for (int i = 0; i < 200; i++)
+		send(sfd, payload, sizeof(payload), 0);
+	run_until(rx, &r, 1000);
+	
+	ASSERT_TRUE(r.count > 0);
+	ASSERT_TRUE(r.errors > 0);
+	ASSERT_EQ(r.last_error, -ENOBUFS);
+	
+	/* Still receiving after the overrun */
+	r.count = 0;
+	send(sfd, payload, 16, 0);
+	run_until(rx, &r, 1);
+	ASSERT_EQ(r.count, 1);
+	ASSERT_EQ(r.len[0], 16);
+	
+	io_recv_destroy(rx);
+	close(rfd);
+	close(sfd);
+}
+
+TEST_SUITE_BEGIN("I/O Receive")
+	RUN_TEST(datagrams_arrive_in_order);
+	RUN_TEST(dry_buffer_ring_is_rearmed);
+	RUN_TEST(oversize_datagram_is_truncated);
+	RUN_TEST(source_address_is_reported);
+	RUN_TEST(set_fd_moves_the_source);
+	RUN_TEST(wake_unblocks_a_waiting_run);
+	RUN_TEST(socket_drops_report_enobufs);
+TEST_SUITE_END()
@@ -0,0 +1,192 @@
+/* test_io_service.c - Unit tests for the asynchronous file write service */
+
+#include "test_framework.h"
+#include "io_service.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_FILE "/tmp/test_unit_io_service.dat"
+
+static _Atomic int completed;
+static _Atomic int failed;
+static _Atomic int last_error;
+
+static void count_done(void *ctx, int result)
+{
+	if (result < 0) {
+		atomic_fetch_add(&failed, 1);
+		atomic_store(&last_error, result);
+	} else {
+		atomic_fetch_add(&completed, 1);
+	}
+}
+
+static void reset_counts(void)
+{
+	atomic_store(&completed, 0);
+	atomic_store(&failed, 0);
+	atomic_store(&last_error, 0);
+}
+
+static struct io_service *create_service(bool no_uring, size_t buffers, size_t size)
+{
+	struct io_service_config config = {
+		.buffer_count = buffers,
+		.buffer_size = size,
+		.no_uring = no_uring,
+	};
+	
+	return io_service_create(&config);
+}
+
+/* Fill the file with numbered blocks from the service and read them back */
+static int write_blocks(bool no_uring, unsigned int flags)
+{
+	struct io_service *svc = create_service(no_uring, 4, 4096);
+	struct io_service_stats stats;
+	char *expect, *got;
+	size_t total = 64 * 1024;
+	int fd, ok = 1;
+	
+	if (!svc)
+		return 0;
+	
+	reset_counts();
+	fd = open(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	expect = malloc(total);
+	got = malloc(total);
+	for (size_t i = 0; i < total; i++)
+		expect[i] = (char)('a' + (i / 4096) % 26);
+	
+	/* 16 blocks through 4 buffers, in flight in any order */
+	for (size_t off = 0; off < total; off += 4096) {
+		struct io_buffer *buf = io_service_buffer(svc);
+		
+		memcpy(buf->data, expect + off, 4096);
+		buf->len = 4096;
+		if (!io_service_write(svc, fd, off, buf, flags, count_done, NULL))
+			ok = 0;
+	}
+	io_service_wait(svc);
+	
+	if (atomic_load(&completed) != 16 || atomic_load(&failed) != 0)
+		ok = 0;
+	if (pread(fd, got, total, 0) != (ssize_t)total || memcmp(expect, got, total) != 0)
+		ok = 0;
+	
+	io_service_get_stats(svc, &stats);
+	if (stats.writes != 16 || stats.bytes != total || stats.errors != 0 ||
+	    stats.uring == no_uring)
+		ok = 0;
+	if ((flags & IO_WRITE_DATASYNC) && stats.syncs != 16)
+		ok = 0;
+	
+	io_service_destroy(svc);
+	close(fd);
+	unlink(TEST_FILE);
+	free(expect);
+	free(got);
+	return ok;
+}
+
+TEST(uring_writes_reach_their_offsets)
+{
+	ASSERT_TRUE(write_blocks(false, 0));
+}
+
+TEST(uring_write_then_datasync_chains)
+{
+	ASSERT_TRUE(write_blocks(false, IO_WRITE_DATASYNC));
+}
+
+TEST(writer_thread_backend)
+{
+	ASSERT_TRUE(write_blocks(true, 0));
+	ASSERT_TRUE(write_blocks(true, IO_WRITE_DATASYNC));
+}
+
+TEST(write_data_splits_into_buffers)
+{
+	struct io_service *svc = create_service(false, 2, 1000);
+	char data[4500], got[4500];
+	int fd;
+	
+	ASSERT_NOT_NULL(svc);
+	reset_counts();
+	for (size_t i = 0; i < sizeof(data); i++)
+		data[i] = (char)(i * 7);
+	
+	fd = open(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	ASSERT_TRUE(fd >= 0);
+	ASSERT_TRUE(io_service_write_data(svc, fd, 100, data, sizeof(data), 0, count_done, NULL));
+	io_service_wait(svc);
+	
+	ASSERT_EQ(atomic_load(&completed), 5);
+	ASSERT_EQ(pread(fd, got, sizeof(got), 100), (ssize_t)sizeof(got));
+	ASSERT_TRUE(memcmp(data, got, sizeof(data)) == 0);
+	
+	io_service_destroy(svc);
+	close(fd);
+	unlink(TEST_FILE);
+}
+
+TEST(failed_write_reports_errno)
+{
+	for (int backend = 0; backend < 2; backend++) {
+		struct io_service *svc = create_service(backend, 2, 4096);
+		struct io_service_stats stats;
+		int fd;
+		
+		ASSERT_NOT_NULL(svc);
+		reset_counts();
+		
+		/* Read-only descriptor, also cancels the linked fdatasync */
+		fd = open(TEST_FILE, O_RDONLY | O_CREAT, 0644);
+		ASSERT_TRUE(fd >= 0);
+		ASSERT_TRUE(io_service_write_data(svc, fd, 0, "x", 1, IO_WRITE_DATASYNC,
+		                                  count_done, NULL));
+		io_service_wait(svc);
+		
+		ASSERT_EQ(atomic_load(&failed), 1);
+		ASSERT_EQ(atomic_load(&last_error), -EBADF);
+		io_service_get_stats(svc, &stats);
+		ASSERT_EQ(stats.errors, 1);
+		ASSERT_EQ(stats.writes, 0);
+		
+		io_service_destroy(svc);
+		close(fd);
+		unlink(TEST_FILE);
+	}
+}
+
+TEST(released_buffers_are_reused)
+{
+	struct io_service *svc = create_service(false, 1, 4096);
+	struct io_buffer *buf;
+	
+	ASSERT_NOT_NULL(svc);
+	for (int i = 0; i < 10; i++) {
+		buf = io_service_buffer(svc);
+		ASSERT_NOT_NULL(buf);
+		ASSERT_EQ(buf->len, 0);
+		ASSERT_EQ(buf->size, 4096);
+		io_service_release(svc, buf);
+	}
+	
+	/* Nothing was submitted */
+	io_service_wait(svc);
+	io_service_destroy(svc);
+}
+
+TEST_SUITE_BEGIN("I/O Service")
+	RUN_TEST(uring_writes_reach_their_offsets);
+	RUN_TEST(uring_write_then_datasync_chains);
+	RUN_TEST(writer_thread_backend);
+	RUN_TEST(write_data_splits_into_buffers);
+	RUN_TEST(failed_write_reports_errno);
+	RUN_TEST(released_buffers_are_reused);
+TEST_SUITE_END()
@@ -0,0 +1,147 @@
+/* test_json_buf.c - Unit tests for the JSON output buffer */
+
+#include "test_framework.h"
+#include "json_buf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Reference escaper, one byte at a time */
+static void escape_slow(char *out, const char *str)
+{
+	for (; *str; str++) {
+		unsigned char c = (unsigned char)*str;
+		
+		switch (c) {
+		case '"':  out += sprintf(out, "\\\""); break;
+		case '\\': out += sprintf(out, "\\\\"); break;
+		case '\b': out += sprintf(out, "\\b"); break;
+		case '\f': out += sprintf(out, "\\f"); break;
+		case '\n': out += sprintf(out, "\\n"); break;
+		case '\r': out += sprintf(out, "\\r"); break;
+		case '\t': out += sprintf(out, "\\t"); break;
+		default:
+			if (c < 32)
+				out += sprintf(out, "\\u%04x", c);
+			else
+				*out++ = c;
+			break;
+		}
+	}
+	*out = '\0';
+}
+
+TEST(json_buf_strings)
+{
+	struct json_buf buf;
+	
+	ASSERT_TRUE(json_buf_init(&buf, 0));
+	json_buf_append_string(&buf, "eth0");
+	json_buf_append_char(&buf, ',');
+	json_buf_append_string(&buf, NULL);
+	json_buf_append_char(&buf, ',');
+	json_buf_append_string(&buf, "a\"b\\c\n\x01\x7f\xc3\xa9");
+	ASSERT_FALSE(buf.failed);
+	ASSERT_STR_EQ(buf.data, "\"eth0\",null,\"a\\\"b\\\\c\\n\\u0001\x7f\xc3\xa9\"");
+	ASSERT_EQ(buf.len, strlen(buf.data));
+	
+	json_buf_reset(&buf);
+	ASSERT_EQ(buf.len, 0);
+	json_buf_append_string(&buf, "");
+	ASSERT_STR_EQ(buf.data, "\"\"");
+	
+	json_buf_free(&buf);
+}
+
+TEST(json_buf_escape_every_position)
+{
+	static const char specials[] = "\"\\\n\t\x1f";
+	char input[80], expected[512];
+	struct json_buf buf;
+	
+	ASSERT_TRUE(json_buf_init(&buf, 16));
+	
+	/* Special characters on both sides of every 16 byte block boundary */
+	for (size_t len = 1; len < sizeof(input); len++) {
+		for (size_t pos = 0; pos < len; pos++) {
+			memset(input, 'x', len);
+			input[len] = '\0';
+			input[pos] = specials[(len + pos) % (sizeof(specials) - 1)];
+			if (len > 40)
+				input[len - 1] = (char)0xe9;
+			
+			escape_slow(expected, input);
+			json_buf_reset(&buf);
+			json_buf_append_escaped(&buf, input, len);
+			ASSERT_FALSE(buf.failed);
+			ASSERT_STR_EQ(buf.data, expected);
+		}
+	}
+	
+	json_buf_free(&buf);
+}
+
+TEST(json_buf_integers)
+{
+	static const uint64_t values[] = {
+		0, 7, 10, 99, 100, 12345, 999999, 1000000, 18446744073709551615ULL
+	};
+	char expected[32];
+	struct json_buf buf;
+	
+	ASSERT_TRUE(json_buf_init(&buf, 0));
+	
+	for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		json_buf_reset(&buf);
+		json_buf_append_u64(&buf, values[i]);
+		snprintf(expected, sizeof(expected), "%llu", (unsigned long long)values[i]);
+		ASSERT_STR_EQ(buf.data, expected);
+		
+		json_buf_reset(&buf);
+		json_buf_append_u64_padded(&buf, values[i], 6);
+		snprintf(expected, sizeof(expected), "%06llu", (unsigned long long)values[i]);
+		ASSERT_STR_EQ(buf.data, expected);
+	}
+	
+	json_buf_reset(&buf);
+	json_buf_append_i64(&buf, INT64_MIN);
+	json_buf_append_char(&buf, ' ');
+	json_buf_append_i64(&buf, -42);
+	json_buf_append_char(&buf, ' ');
+	json_buf_append_i64(&buf, INT64_MAX);
+	ASSERT_STR_EQ(buf.data, "-9223372036854775808 -42 9223372036854775807");
+	
+	json_buf_free(&buf);
+}
+
+TEST(json_buf_growth_and_detach)
+{
+	struct json_buf buf;
+	char *text;
+	
+	ASSERT_TRUE(json_buf_init(&buf, 0));
+	for (int i = 0; i < 10000; i++)
+		json_buf_append_str(&buf, "0123456789");
+	ASSERT_FALSE(buf.failed);
+	ASSERT_EQ(buf.len, 100000);
+	
+	text = json_buf_detach(&buf);
+	ASSERT_NOT_NULL(text);
+	ASSERT_EQ(strlen(text), 100000);
+	ASSERT_NULL(buf.data);
+	ASSERT_EQ(buf.len, 0);
+	free(text);
+	
+	/* An empty buffer still detaches an empty string */
+	text = json_buf_detach(&buf);
+	ASSERT_NOT_NULL(text);
+	ASSERT_STR_EQ(text, "");
+	free(text);
+}
+
+TEST_SUITE_BEGIN("JSON Buffer")
+	RUN_TEST(json_buf_strings);
+	RUN_TEST(json_buf_escape_every_position);
+	RUN_TEST(json_buf_integers);
+	RUN_TEST(json_buf_growth_and_detach);
+TEST_SUITE_END()
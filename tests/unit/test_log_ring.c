@@ -0,0 +1,157 @@
+/* test_log_ring.c - Unit tests for deferred binary logging */
+
+#include "test_framework.h"
+#include "log_ring.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define MAX_LINES 64
+
+static char lines[MAX_LINES][NLMON_LOG_LINE_MAX];
+static int nlines;
+
+static void capture_sink(const struct nlmon_log_record *rec, const char *text, void *ctx)
+{
+	(void)rec;
+	(void)ctx;
+	if (nlines < MAX_LINES) {
+		snprintf(lines[nlines], sizeof(lines[0]), "%s", text);
+		nlines++;
+	}
+}
+
+static int evaluated;
+
+static int side_effect(void)
+{
+	return ++evaluated;
+}
+
+static int render_sum(const struct nlmon_log_record *rec, char *buf, size_t len)
+{
+	return snprintf(buf, len, "sum=%llu", (unsigned long long)(rec->args[0] + rec->args[1]));
+}
+
+TEST(log_format_conversions)
+{
+	nlines = 0;
+	nlmon_log_set_sink(capture_sink, NULL);
+
+	NLMON_LOG(NLMON_LOG_INFO, NULL, "plain");
+	NLMON_LOG(NLMON_LOG_INFO, NULL, "%d %u %x %5.2f %s %c %%", -3, 4000000000u, 255, 3.14159,
+	          "str", 'z');
+	NLMON_LOG(NLMON_LOG_INFO, "T", "%lu/%zu/%llu/%hhu", 1UL, (size_t)2, 3ULL, 4);
+	NLMON_LOG(NLMON_LOG_INFO, NULL, "%-4d|%04x|%s", 7, 10, (const char *)NULL);
+	NLMON_LOG_RENDER(NLMON_LOG_INFO, NULL, render_sum, 40, 2);
+
+	/* Synchronous without a ring */
+	ASSERT_EQ(nlines, 5);
+	ASSERT_STR_EQ(lines[0], "plain");
+	ASSERT_STR_EQ(lines[1], "-3 4000000000 ff  3.14 str z %");
+	ASSERT_STR_EQ(lines[2], "1/2/3/4");
+	ASSERT_STR_EQ(lines[3], "7   |000a|(null)");
+	ASSERT_STR_EQ(lines[4], "sum=42");
+
+	nlmon_log_set_sink(NULL, NULL);
+}
+
+TEST(log_format_truncates)
+{
+	static const struct nlmon_log_site site = { "%s-%d", NULL, NLMON_LOG_INFO, NULL };
+	struct nlmon_log_record rec = { .site = &site, .nargs = 2 };
+	char buf[6];
+
+	rec.args[0] = nlmon_log_arg_ptr("abcdef");
+	rec.args[1] = nlmon_log_arg_int(12);
+	ASSERT_EQ(nlmon_log_format(&rec, buf, sizeof(buf)), 9);
+	ASSERT_STR_EQ(buf, "abcde");
+
+	/* Missing arguments stop formatting */
+	rec.nargs = 1;
+	ASSERT_EQ(nlmon_log_format(&rec, buf, sizeof(buf)), 7);
+}
+
+TEST(log_ring_deferred)
+{
+	struct nlmon_log_stats stats;
+	int level = NLMON_LOG_WARN;
+	int i;
+
+	nlines = 0;
+	nlmon_log_set_sink(capture_sink, NULL);
+	ASSERT_EQ(nlmon_log_start(4), 0);
+	ASSERT_EQ(nlmon_log_start(4), -EALREADY);
+
+	/* A disabled level does not evaluate its arguments */
+	evaluated = 0;
+	if (NLMON_LOG_DEBUG <= level)
+		NLMON_LOG(NLMON_LOG_DEBUG, NULL, "%d", side_effect());
+	ASSERT_EQ(evaluated, 0);
+
+	for (i = 0; i < 3; i++)
+		NLMON_LOG(NLMON_LOG_WARN, NULL, "record %d", i);
+
+	nlmon_log_stop();
+	nlmon_log_set_sink(NULL, NULL);
+
+	ASSERT_EQ(nlines, 3);
+	ASSERT_STR_EQ(lines[0], "record 0");
+	ASSERT_STR_EQ(lines[2], "record 2");
+
+	/* Back to synchronous */
+	nlmon_log_get_stats(&stats);
+	ASSERT_EQ(stats.logged, 0);
+}
+
+static void *flood(void *arg)
+{
+	int i;
+
+	(void)arg;
+	for (i = 0; i < 10000; i++)
+		NLMON_LOG(NLMON_LOG_INFO, NULL, "flood %d", i);
+	return NULL;
+}
+
+static unsigned long counted;
+
+static void count_sink(const struct nlmon_log_record *rec, const char *text, void *ctx)
+{
+	(void)rec;
+	(void)text;
+	(void)ctx;
+	counted++;
+}
+
+TEST(log_ring_full_drops)
+{
+	struct nlmon_log_stats stats;
+	pthread_t threads[4];
+	int i;
+
+	counted = 0;
+	nlmon_log_set_sink(count_sink, NULL);
+	ASSERT_EQ(nlmon_log_start(64), 0);
+
+	for (i = 0; i < 4; i++)
+		pthread_create(&threads[i], NULL, flood, NULL);
+	for (i = 0; i < 4; i++)
+		pthread_join(threads[i], NULL);
+
+	nlmon_log_get_stats(&stats);
+	ASSERT_EQ(stats.logged, 40000);
+	nlmon_log_stop();
+	nlmon_log_set_sink(NULL, NULL);
+
+	/* Every record is either delivered or counted as dropped */
+	ASSERT_EQ(counted + stats.dropped, 40000);
+}
+
+TEST_SUITE_BEGIN("Deferred Logging")
+	RUN_TEST(log_format_conversions);
+	RUN_TEST(log_format_truncates);
+	RUN_TEST(log_ring_deferred);
+	RUN_TEST(log_ring_full_drops);
+TEST_SUITE_END()
@@ -0,0 +1,216 @@
+/* test_memory_governor.c - Unit tests for the memory budget governor */
+
+#include "test_framework.h"
+#include "memory_governor.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MB (1024 * 1024)
+
+/* Subsystem that holds what the test says and records what it is told */
+struct fake_subsystem {
+	size_t usage;
+	enum memory_pressure level;
+	size_t target;
+	int calls;
+};
+
+static size_t fake_usage(void *ctx)
+{
+	return ((struct fake_subsystem *)ctx)->usage;
+}
+
+static void fake_respond(void *ctx, enum memory_pressure level, size_t target)
+{
+	struct fake_subsystem *sub = ctx;
+	
+	sub->level = level;
+	sub->target = target;
+	sub->calls++;
+}
+
+static struct memory_governor *create_governor(size_t budget)
+{
+	struct memory_governor_config config = {
+		.budget = budget,
+	};
+	
+	return memory_governor_create(&config);
+}
+
+TEST(levels_follow_budget_use)
+{
+	struct memory_governor *gov = create_governor(100 * MB);
+	struct fake_subsystem a = { 0 };
+	struct memory_governor_stats stats;
+	
+	ASSERT_NOT_NULL(gov);
+	ASSERT_EQ(memory_governor_add(gov, "a", 100, fake_usage, fake_respond, &a), 0);
+	
+	a.usage = 50 * MB;
+	ASSERT_EQ(memory_governor_check(gov), MEMORY_PRESSURE_NONE);
+	a.usage = 72 * MB;
+	ASSERT_EQ(memory_governor_check(gov), MEMORY_PRESSURE_LOW);
+	a.usage = 88 * MB;
+	ASSERT_EQ(memory_governor_check(gov), MEMORY_PRESSURE_HIGH);
+	a.usage = 99 * MB;
+	ASSERT_EQ(memory_governor_check(gov), MEMORY_PRESSURE_CRITICAL);
+	ASSERT_EQ(memory_governor_level(gov), MEMORY_PRESSURE_CRITICAL);
+	
+	memory_governor_get_stats(gov, &stats);
+	ASSERT_EQ(stats.budget, 100 * MB);
+	ASSERT_EQ(stats.usage, 99 * MB);
+	ASSERT_EQ(stats.checks, 4);
+	ASSERT_EQ(stats.escalations, 3);
+	ASSERT_EQ(stats.peak_level, MEMORY_PRESSURE_CRITICAL);
+	ASSERT_EQ(stats.num_subsystems, 1);
+	
+	memory_governor_destroy(gov);
+}
+
+TEST(levels_drop_past_the_hysteresis)
+{
+	struct memory_governor *gov = create_governor(100 * MB);
+	struct fake_subsystem a = { 0 };
+	
+	ASSERT_NOT_NULL(gov);
+	ASSERT_EQ(memory_governor_add(gov, "a", 50, fake_usage, fake_respond, &a), 0);
+	
+	a.usage = 90 * MB;
+	ASSERT_EQ(memory_governor_check(gov), MEMORY_PRESSURE_HIGH);
+	
+	/* Just under the threshold is not enough */
+	a.usage = 82 * MB;
+	ASSERT_EQ(memory_governor_check(gov), MEMORY_PRESSURE_HIGH);
+	a.usage = 79 * MB;
+	ASSERT_EQ(memory_governor_check(gov), MEMORY_PRESSURE_LOW);
+	
+	/* Several levels at once when use falls far enough */
+	a.usage = 99 * MB;
+	ASSERT_EQ(memory_governor_check(gov), MEMORY_PRESSURE_CRITICAL);
+	a.usage = 10 * MB;
+	ASSERT_EQ(memory_governor_check(gov), MEMORY_PRESSURE_NONE);
+	
+	memory_governor_destroy(gov);
+}
+
+TEST(subsystems_over_their_share_get_the_level)
+{
+	struct memory_governor *gov = create_governor(100 * MB);
+	struct fake_subsystem big = { 0 }, small = { 0 };
+	
+	ASSERT_NOT_NULL(gov);
+	ASSERT_EQ(memory_governor_add(gov, "big", 40, fake_usage, fake_respond, &big), 0);
+	ASSERT_EQ(memory_governor_add(gov, "small", 40, fake_usage, fake_respond, &small), 0);
+	
+	/* Without pressure nobody hears anything */
+	big.usage = 50 * MB;
+	small.usage = 10 * MB;
+	memory_governor_check(gov);
+	ASSERT_EQ(big.calls, 0);
+	ASSERT_EQ(small.calls, 0);
+	
+	/* HIGH for the one over its share, LOW within it, both kept to the share */
+	big.usage = 80 * MB;
+	ASSERT_EQ(memory_governor_check(gov), MEMORY_PRESSURE_HIGH);
+	ASSERT_EQ(big.level, MEMORY_PRESSURE_HIGH);
+	ASSERT_EQ(big.target, 40 * MB);
+	ASSERT_EQ(small.level, MEMORY_PRESSURE_LOW);
+	ASSERT_EQ(small.target, 40 * MB);
+	
+	/* Unchanged levels are not told again */
+	memory_governor_check(gov);
+	ASSERT_EQ(big.calls, 1);
+	ASSERT_EQ(small.calls, 1);
+	
+	/* Critical asks for room below the share */
+	big.usage = 90 * MB;
+	ASSERT_EQ(memory_governor_check(gov), MEMORY_PRESSURE_CRITICAL);
+	ASSERT_EQ(big.level, MEMORY_PRESSURE_CRITICAL);
+	ASSERT_TRUE(big.target < 40 * MB);
+	ASSERT_EQ(small.level, MEMORY_PRESSURE_LOW);
+	
+	/* Once it gave memory back the limits are lifted */
+	big.usage = 20 * MB;
+	ASSERT_EQ(memory_governor_check(gov), MEMORY_PRESSURE_NONE);
+	ASSERT_EQ(big.level, MEMORY_PRESSURE_NONE);
+	ASSERT_EQ(big.target, 0);
+	ASSERT_EQ(small.level, MEMORY_PRESSURE_NONE);
+	
+	memory_governor_destroy(gov);
+}
+
+TEST(subsystem_stats)
+{
+	struct memory_governor *gov = create_governor(10 * MB);
+	struct fake_subsystem a = { .usage = 2 * MB };
+	struct memory_subsystem_stats subs[4];
+	
+	ASSERT_NOT_NULL(gov);
+	ASSERT_EQ(memory_governor_add(gov, "accounted", 30, fake_usage, NULL, &a), 0);
+	memory_governor_check(gov);
+	
+	ASSERT_EQ(memory_governor_get_subsystems(gov, subs, 4), 1);
+	ASSERT_STR_EQ(subs[0].name, "accounted");
+	ASSERT_EQ(subs[0].usage, 2 * MB);
+	ASSERT_EQ(subs[0].share, 3 * MB);
+	ASSERT_EQ(subs[0].level, MEMORY_PRESSURE_NONE);
+	ASSERT_EQ(subs[0].responses, 0);
+	
+	memory_governor_destroy(gov);
+}
+
+TEST(invalid_configuration)
+{
+	struct memory_governor_config config = { .budget = 0 };
+	struct memory_governor *gov;
+	struct fake_subsystem a = { 0 };
+	
+	ASSERT_NULL(memory_governor_create(NULL));
+	ASSERT_NULL(memory_governor_create(&config));
+	
+	/* Thresholds out of order */
+	config.budget = MB;
+	config.low_pct = 90;
+	config.high_pct = 80;
+	ASSERT_NULL(memory_governor_create(&config));
+	
+	/* Shares add up to the whole budget at most */
+	gov = create_governor(MB);
+	ASSERT_NOT_NULL(gov);
+	ASSERT_EQ(memory_governor_add(gov, "a", 60, fake_usage, fake_respond, &a), 0);
+	ASSERT_EQ(memory_governor_add(gov, "b", 50, fake_usage, fake_respond, &a), -1);
+	ASSERT_EQ(memory_governor_add(gov, "b", 40, fake_usage, fake_respond, &a), 0);
+	ASSERT_EQ(memory_governor_add(gov, "c", 0, NULL, fake_respond, &a), -1);
+	
+	ASSERT_STR_EQ(memory_pressure_name(MEMORY_PRESSURE_HIGH), "high");
+	memory_governor_destroy(gov);
+}
+
+TEST(resident_set_counts)
+{
+	struct memory_governor_config config = {
+		.budget = 4096,
+		.count_rss = true,
+	};
+	struct memory_governor *gov = memory_governor_create(&config);
+	struct memory_governor_stats stats;
+	
+	/* No subsystem reports, the process itself is over a tiny budget */
+	ASSERT_NOT_NULL(gov);
+	ASSERT_EQ(memory_governor_check(gov), MEMORY_PRESSURE_CRITICAL);
+	memory_governor_get_stats(gov, &stats);
+	ASSERT_TRUE(stats.rss > 4096);
+	ASSERT_EQ(stats.usage, 0);
+	
+	memory_governor_destroy(gov);
+}
+
+TEST_SUITE_BEGIN("Memory Governor")
+	RUN_TEST(levels_follow_budget_use);
+	RUN_TEST(levels_drop_past_the_hysteresis);
+	RUN_TEST(subsystems_over_their_share_get_the_level);
+	RUN_TEST(subsystem_stats);
+	RUN_TEST(invalid_configuration);
+	RUN_TEST(resident_set_counts);
+TEST_SUITE_END()
@@ -0,0 +1,173 @@
+/* test_memory_tracker.c - Unit tests for allocation tracking */
+
+#include "test_framework.h"
+#include "memory_tracker.h"
+#include <pthread.h>
+#include <string.h>
+
+#define TRACK_THREADS 8
+#define TRACK_PER_THREAD 100000
+
+/* Pointers are only keys to the tracker, they are never dereferenced */
+static void *fake_ptr(uintptr_t n)
+{
+	return (void *)((n + 1) * 64);
+}
+
+static void alloc_events(struct memory_tracker *tracker, uintptr_t base, int count)
+{
+	for (int i = 0; i < count; i++)
+		memory_tracker_alloc_here(tracker, 100, fake_ptr(base + i), "events");
+}
+
+struct track_arg {
+	struct memory_tracker *tracker;
+	uintptr_t base;
+};
+
+static void *track_thread(void *data)
+{
+	struct track_arg *arg = data;
+	
+	for (int i = 0; i < TRACK_PER_THREAD; i++)
+		memory_tracker_alloc_here(arg->tracker, 32, fake_ptr(arg->base + i), "threads");
+	for (int i = 0; i < TRACK_PER_THREAD; i++)
+		memory_tracker_free(arg->tracker, fake_ptr(arg->base + i));
+	return NULL;
+}
+
+TEST(tracker_sites)
+{
+	struct memory_tracker *tracker = memory_tracker_create(true);
+	struct memory_site_stats sites[8];
+	struct memory_stats stats;
+	int n;
+	
+	ASSERT_NOT_NULL(tracker);
+	
+	alloc_events(tracker, 0, 20000);
+	for (int i = 0; i < 5000; i++)
+		memory_tracker_alloc_here(tracker, 10, fake_ptr(100000 + i), "events");
+	memory_tracker_alloc_here(tracker, 5000, fake_ptr(200000), "storage");
+	memory_tracker_alloc(tracker, 7, fake_ptr(300000));
+	
+	/* Half of the first site is freed, and frees of unknown pointers count only */
+	for (int i = 0; i < 20000; i += 2)
+		memory_tracker_free(tracker, fake_ptr(i));
+	memory_tracker_free(tracker, fake_ptr(400000));
+	
+	ASSERT_TRUE(memory_tracker_get_stats(tracker, &stats));
+	ASSERT_EQ(stats.alloc_count, 25002);
+	ASSERT_EQ(stats.free_count, 10001);
+	ASSERT_EQ(stats.tracked, 15002);
+	ASSERT_EQ(stats.current_usage, 10000 * 100 + 5000 * 10 + 5000 + 7);
+	ASSERT_EQ(stats.peak_usage, 20000 * 100 + 5000 * 10 + 5000 + 7);
+	ASSERT_EQ(stats.sample_interval, 0);
+	
+	n = memory_tracker_get_sites(tracker, sites, 8);
+	ASSERT_EQ(n, 4);
+	ASSERT_EQ(sites[0].live_bytes, 10000 * 100);
+	ASSERT_EQ(sites[0].live_count, 10000);
+	ASSERT_EQ(sites[0].total_count, 20000);
+	ASSERT_STR_EQ(sites[0].subsystem, "events");
+	ASSERT_NOT_NULL(strstr(sites[0].site, "test_memory_tracker.c:"));
+	ASSERT_EQ(sites[3].live_bytes, 7);
+	ASSERT_STR_EQ(sites[3].subsystem, "unknown");
+	
+	/* Both events sites fold into one subsystem */
+	n = memory_tracker_get_subsystems(tracker, sites, 8);
+	ASSERT_EQ(n, 3);
+	ASSERT_STR_EQ(sites[0].subsystem, "events");
+	ASSERT_NULL(sites[0].site);
+	ASSERT_EQ(sites[0].live_bytes, 10000 * 100 + 5000 * 10);
+	ASSERT_EQ(sites[0].live_count, 15000);
+	ASSERT_STR_EQ(sites[1].subsystem, "storage");
+	
+	/* A pointer seen again without its free replaces the old entry */
+	memory_tracker_alloc(tracker, 9, fake_ptr(300000));
+	ASSERT_TRUE(memory_tracker_get_stats(tracker, &stats));
+	ASSERT_EQ(stats.tracked, 15002);
+	ASSERT_EQ(stats.current_usage, 10000 * 100 + 5000 * 10 + 5000 + 9);
+	
+	/* Totals start over, live allocations stay */
+	memory_tracker_reset_stats(tracker);
+	n = memory_tracker_get_sites(tracker, sites, 8);
+	ASSERT_EQ(n, 4);
+	ASSERT_EQ(sites[0].live_count, 10000);
+	ASSERT_EQ(sites[0].total_count, 0);
+	
+	memory_tracker_destroy(tracker);
+}
+
+TEST(tracker_sampling)
+{
+	struct memory_tracker *tracker = memory_tracker_create(true);
+	struct memory_site_stats site;
+	struct memory_stats stats;
+	const int count = 1 << 22;
+	double estimate;
+	
+	ASSERT_NOT_NULL(tracker);
+	
+	/* About 1 in 1024 of these is tracked */
+	memory_tracker_set_sampling(tracker, 64 * 1024);
+	for (int i = 0; i < count; i++)
+		memory_tracker_alloc_here(tracker, 64, fake_ptr(i), "sampled");
+	memory_tracker_alloc_here(tracker, 1 << 20, fake_ptr(count), "large");
+	
+	ASSERT_TRUE(memory_tracker_get_stats(tracker, &stats));
+	ASSERT_EQ(stats.alloc_count, (unsigned long)count + 1);
+	ASSERT_EQ(stats.sample_interval, 64 * 1024);
+	ASSERT_TRUE(stats.tracked > count / 1024 * 0.8 && stats.tracked < count / 1024 * 1.2);
+	
+	/* Size weighted, the estimate is close to what was allocated */
+	estimate = (double)stats.current_usage - (1 << 20);
+	ASSERT_TRUE(estimate > 64.0 * count * 0.9 && estimate < 64.0 * count * 1.1);
+	ASSERT_EQ(memory_tracker_get_subsystems(tracker, &site, 1), 1);
+	ASSERT_STR_EQ(site.subsystem, "sampled");
+	ASSERT_TRUE(site.live_count > count * 0.9 && site.live_count < count * 1.1);
+	
+	for (int i = 0; i <= count; i++)
+		memory_tracker_free(tracker, fake_ptr(i));
+	ASSERT_TRUE(memory_tracker_get_stats(tracker, &stats));
+	ASSERT_EQ(stats.tracked, 0);
+	ASSERT_EQ(stats.current_usage, 0);
+	
+	memory_tracker_destroy(tracker);
+}
+
+TEST(tracker_concurrent)
+{
+	struct memory_tracker *tracker = memory_tracker_create(true);
+	pthread_t threads[TRACK_THREADS];
+	struct track_arg args[TRACK_THREADS];
+	struct memory_site_stats site;
+	struct memory_stats stats;
+	
+	ASSERT_NOT_NULL(tracker);
+	
+	for (int i = 0; i < TRACK_THREADS; i++) {
+		args[i].tracker = tracker;
+		args[i].base = (uintptr_t)i * TRACK_PER_THREAD;
+		ASSERT_EQ(pthread_create(&threads[i], NULL, track_thread, &args[i]), 0);
+	}
+	for (int i = 0; i < TRACK_THREADS; i++)
+		pthread_join(threads[i], NULL);
+	
+	ASSERT_TRUE(memory_tracker_get_stats(tracker, &stats));
+	ASSERT_EQ(stats.alloc_count, (unsigned long)TRACK_THREADS * TRACK_PER_THREAD);
+	ASSERT_EQ(stats.free_count, (unsigned long)TRACK_THREADS * TRACK_PER_THREAD);
+	ASSERT_EQ(stats.tracked, 0);
+	ASSERT_EQ(stats.current_usage, 0);
+	ASSERT_EQ(memory_tracker_get_sites(tracker, &site, 1), 1);
+	ASSERT_EQ(site.total_count, (size_t)TRACK_THREADS * TRACK_PER_THREAD);
+	ASSERT_EQ(site.live_count, 0);
+	
+	memory_tracker_destroy(tracker);
+}
+
+TEST_SUITE_BEGIN("Memory Tracker")
+	RUN_TEST(tracker_sites);
+	RUN_TEST(tracker_sampling);
+	RUN_TEST(tracker_concurrent);
+TEST_SUITE_END()
@@ -0,0 +1,153 @@
+/* test_multi_protocol.c - Unit tests for fair epoll dispatch of the multi-protocol sockets */
+
+#include "test_framework.h"
+#include "netlink_multi_protocol.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/genetlink.h>
+
+struct counts {
+	int link;
+	int generic;
+};
+
+static void count_event(nlmon_event_type_t type, void *data, void *user_data)
+{
+	struct counts *c = user_data;
+
+	(void)data;
+	if (type == NLMON_EVENT_LINK)
+		c->link++;
+	else if (type == NLMON_EVENT_GENERIC)
+		c->generic++;
+}
+
+/* Ask for loopback, the reply is one datagram */
+static int request_link(int sock)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct ifinfomsg ifi;
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_type = RTM_GETLINK;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST;
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = 1;
+	return send(sock, &req, sizeof(req), 0) == sizeof(req) ? 0 : -1;
+}
+
+/* Ask for the nlctrl family, the reply is one datagram */
+static int request_family(int sock)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct genlmsghdr genl;
+		struct nlattr nla;
+		char name[8];
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_type = GENL_ID_CTRL;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST;
+	req.genl.cmd = CTRL_CMD_GETFAMILY;
+	req.genl.version = 1;
+	req.nla.nla_type = CTRL_ATTR_FAMILY_NAME;
+	req.nla.nla_len = NLA_HDRLEN + sizeof("nlctrl");
+	strcpy(req.name, "nlctrl");
+	return send(sock, &req, sizeof(req), 0) == sizeof(req) ? 0 : -1;
+}
+
+static int epoll_readable(struct nlmon_multi_protocol_ctx *ctx)
+{
+	struct pollfd pfd = { .fd = nlmon_multi_protocol_get_epoll_fd(ctx), .events = POLLIN };
+
+	return poll(&pfd, 1, 100) == 1;
+}
+
+TEST(multi_protocol_config)
+{
+	struct nlmon_multi_protocol_ctx *ctx = nlmon_multi_protocol_init();
+	struct nlmon_multi_protocol_stats stats;
+
+	ASSERT_NOT_NULL(ctx);
+	ASSERT_TRUE(nlmon_multi_protocol_get_epoll_fd(ctx) >= 0);
+
+	ASSERT_EQ(nlmon_multi_protocol_set_weight(ctx, NLMON_PROTO_GENERIC, 0), -1);
+	ASSERT_EQ(nlmon_multi_protocol_set_weight(ctx, NLMON_PROTO_GENERIC, 3), 0);
+	ASSERT_EQ(nlmon_multi_protocol_set_budget(ctx, 0), -1);
+
+	ASSERT_EQ(nlmon_multi_protocol_get_stats(ctx, NLMON_PROTO_GENERIC, &stats), 0);
+	ASSERT_EQ(stats.weight, 3);
+	ASSERT_EQ(stats.datagrams, 0);
+
+	/* Nothing enabled, nothing to do */
+	ASSERT_EQ(nlmon_multi_protocol_dispatch(ctx), 0);
+
+	nlmon_multi_protocol_destroy(ctx);
+}
+
+TEST(multi_protocol_fair_dispatch)
+{
+	struct nlmon_multi_protocol_ctx *ctx = nlmon_multi_protocol_init();
+	struct nlmon_multi_protocol_stats route, genl;
+	struct counts c = { 0, 0 };
+	int route_fd, genl_fd, i;
+
+	ASSERT_NOT_NULL(ctx);
+	ASSERT_EQ(nlmon_multi_protocol_enable(ctx, NLMON_PROTO_ROUTE), 0);
+	ASSERT_EQ(nlmon_multi_protocol_enable(ctx, NLMON_PROTO_GENERIC), 0);
+	nlmon_multi_protocol_set_callback(ctx, count_event, &c);
+
+	/* Two datagrams per dispatch, generic weighs twice as much */
+	ASSERT_EQ(nlmon_multi_protocol_set_budget(ctx, 2), 0);
+	ASSERT_EQ(nlmon_multi_protocol_set_weight(ctx, NLMON_PROTO_GENERIC, 2), 0);
+
+	route_fd = nlmon_multi_protocol_get_fd(ctx, NLMON_PROTO_ROUTE);
+	genl_fd = nlmon_multi_protocol_get_fd(ctx, NLMON_PROTO_GENERIC);
+	for (i = 0; i < 6; i++) {
+		ASSERT_EQ(request_link(route_fd), 0);
+		ASSERT_EQ(request_family(genl_fd), 0);
+	}
+
+	ASSERT_TRUE(epoll_readable(ctx));
+	ASSERT_EQ(nlmon_multi_protocol_dispatch(ctx), 6);
+	ASSERT_EQ(c.link, 2);
+	ASSERT_EQ(c.generic, 4);
+
+	/* Both were left with data and re-armed */
+	ASSERT_TRUE(epoll_readable(ctx));
+	ASSERT_EQ(nlmon_multi_protocol_dispatch(ctx), 4);
+	ASSERT_EQ(c.link, 4);
+	ASSERT_EQ(c.generic, 6);
+
+	ASSERT_TRUE(epoll_readable(ctx));
+	ASSERT_EQ(nlmon_multi_protocol_dispatch(ctx), 2);
+	ASSERT_EQ(c.link, 6);
+
+	ASSERT_FALSE(epoll_readable(ctx));
+
+	ASSERT_EQ(nlmon_multi_protocol_get_stats(ctx, NLMON_PROTO_ROUTE, &route), 0);
+	ASSERT_EQ(nlmon_multi_protocol_get_stats(ctx, NLMON_PROTO_GENERIC, &genl), 0);
+	ASSERT_EQ(route.datagrams, 6);
+	ASSERT_EQ(route.budget_exhausted, 2);
+	ASSERT_EQ(genl.datagrams, 6);
+	ASSERT_EQ(genl.budget_exhausted, 1);
+	ASSERT_EQ(route.backlog, 0);
+
+	nlmon_multi_protocol_destroy(ctx);
+}
+
+TEST_SUITE_BEGIN("Multi-Protocol Dispatch")
+	RUN_TEST(multi_protocol_config);
+	RUN_TEST(multi_protocol_fair_dispatch);
+TEST_SUITE_END()
@@ -0,0 +1,166 @@
+/* test_name_table.c - Unit tests for ID/name lookup tables */
+
+#include "test_framework.h"
+#include "name_table.h"
+#include "qca_wmi.h"
+#include "qca_vendor.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TABLE_THREADS 8
+
+static const struct name_table_entry dense_entries[] = {
+	{ 10, "TEN" },
+	{ 11, "ELEVEN" },
+	{ 13, "THIRTEEN" },
+	{ 11, "ALIAS" },
+};
+
+static const struct name_table_entry sparse_entries[] = {
+	{ 0x9000, "START_SCAN" },
+	{ 0x16004, "REQUEST_LINK_STATS" },
+	{ 0x1CFF4, "DBGLOG_TIME_STAMP_SYNC" },
+	{ 0, "ZERO" },
+	{ UINT32_MAX, "LAST" },
+};
+
+TEST(name_table_dense)
+{
+	static struct name_table table = NAME_TABLE_INIT(dense_entries);
+	uint32_t id = 0;
+	
+	ASSERT_STR_EQ(name_table_name(&table, 10), "TEN");
+	ASSERT_STR_EQ(name_table_name(&table, 13), "THIRTEEN");
+	ASSERT_NULL(name_table_name(&table, 12));
+	ASSERT_NULL(name_table_name(&table, 9));
+	ASSERT_NULL(name_table_name(&table, 14));
+	
+	/* The first name of an ID wins, both find it */
+	ASSERT_STR_EQ(name_table_name(&table, 11), "ELEVEN");
+	ASSERT_TRUE(name_table_find(&table, "ALIAS", 5, &id));
+	ASSERT_EQ(id, 11);
+	ASSERT_TRUE(name_table_find(&table, "ELEVEN", 6, &id));
+	ASSERT_EQ(id, 11);
+}
+
+TEST(name_table_sparse)
+{
+	static struct name_table table = NAME_TABLE_INIT(sparse_entries);
+	uint32_t id = 0;
+	
+	for (size_t i = 0; i < sizeof(sparse_entries) / sizeof(sparse_entries[0]); i++) {
+		const char *name = sparse_entries[i].name;
+		
+		ASSERT_STR_EQ(name_table_name(&table, sparse_entries[i].id), name);
+		ASSERT_TRUE(name_table_find(&table, name, strlen(name), &id));
+		ASSERT_EQ(id, sparse_entries[i].id);
+	}
+	ASSERT_NULL(name_table_name(&table, 0x9001));
+	ASSERT_NULL(name_table_name(&table, 1));
+}
+
+TEST(name_table_find_prefix)
+{
+	static struct name_table table = NAME_TABLE_INIT(sparse_entries);
+	const char *line = "START_SCAN command_id:36864";
+	uint32_t id = 0;
+	
+	/* Names are matched whole, not by prefix */
+	ASSERT_TRUE(name_table_find(&table, line, 10, &id));
+	ASSERT_EQ(id, 0x9000);
+	ASSERT_FALSE(name_table_find(&table, line, 9, &id));
+	ASSERT_FALSE(name_table_find(&table, line, 11, &id));
+	ASSERT_FALSE(name_table_find(&table, "", 0, &id));
+}
+
+static struct name_table shared_table = NAME_TABLE_INIT(sparse_entries);
+
+static void *lookup_thread(void *arg)
+{
+	int *failures = arg;
+	
+	for (int i = 0; i < 1000; i++) {
+		const char *name = name_table_name(&shared_table, 0x16004);
+		
+		if (!name || strcmp(name, "REQUEST_LINK_STATS") != 0)
+			(*failures)++;
+	}
+	return NULL;
+}
+
+TEST(name_table_concurrent_first_use)
+{
+	pthread_t threads[TABLE_THREADS];
+	int failures[TABLE_THREADS] = {0};
+	
+	/* All threads may race to build the index */
+	for (int i = 0; i < TABLE_THREADS; i++)
+		ASSERT_EQ(pthread_create(&threads[i], NULL, lookup_thread, &failures[i]), 0);
+	for (int i = 0; i < TABLE_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+		ASSERT_EQ(failures[i], 0);
+	}
+}
+
+TEST(name_table_wmi_cmds)
+{
+	unsigned int cmd_id = 0;
+	
+	ASSERT_STR_EQ(wmi_cmd_to_string(WMI_START_SCAN_CMDID), "START_SCAN");
+	ASSERT_STR_EQ(wmi_cmd_to_string(WMI_REQUEST_LINK_STATS_CMDID), "REQUEST_LINK_STATS");
+	ASSERT_STR_EQ(wmi_cmd_to_string(WMI_P2P_GO_SET_BEACON_IE), "P2P_GO_SET_BEACON_IE");
+	ASSERT_STR_EQ(wmi_cmd_to_string(0x1234), "UNKNOWN");
+	ASSERT_STR_EQ(wmi_stats_to_string(WMI_STATS_TYPE_LINK_LAYER), "LINK_LAYER_STATS");
+	ASSERT_STR_EQ(wmi_stats_to_string(5), "UNKNOWN_STATS");
+	
+	ASSERT_EQ(wmi_cmd_from_string("WMI_REQUEST_LINK_STATS_CMDID", 28, &cmd_id), 0);
+	ASSERT_EQ(cmd_id, WMI_REQUEST_LINK_STATS_CMDID);
+	ASSERT_EQ(wmi_cmd_from_string("VDEV_UP", 7, &cmd_id), 0);
+	ASSERT_EQ(cmd_id, WMI_VDEV_UP_CMDID);
+	ASSERT_EQ(wmi_cmd_from_string("WMI_STA_KEEPALIVE_CMD", 21, &cmd_id), 0);
+	ASSERT_EQ(cmd_id, WMI_STA_KEEPALIVE_CMD);
+	ASSERT_EQ(wmi_cmd_from_string("WMI_NO_SUCH_CMDID", 17, &cmd_id), -1);
+}
+
+TEST(name_table_wmi_log_name_only)
+{
+	struct wmi_log_entry entry;
+	
+	/* Without a command_id the ID comes from the name */
+	ASSERT_EQ(wmi_parse_log_line("[0x1a2b] Send WMI command:WMI_VDEV_UP_CMDID htc_tag:1",
+	                             &entry), WMI_SUCCESS);
+	ASSERT_STR_EQ(entry.command_name, "WMI_VDEV_UP_CMDID");
+	ASSERT_EQ(entry.cmd_id, WMI_VDEV_UP_CMDID);
+}
+
+TEST(name_table_vendor)
+{
+	unsigned int id = 0;
+	
+	ASSERT_STR_EQ(qca_vendor_subcmd_to_string(QCA_NL80211_VENDOR_SUBCMD_LL_STATS_GET),
+	              "LL_STATS_GET");
+	ASSERT_STR_EQ(qca_vendor_subcmd_to_string(QCA_NL80211_VENDOR_SUBCMD_ATF_OFFLOAD_OPS),
+	              "ATF_OFFLOAD_OPS");
+	ASSERT_NULL(qca_vendor_subcmd_to_string(2));
+	ASSERT_EQ(qca_vendor_subcmd_from_string("QCA_NL80211_VENDOR_SUBCMD_DO_ACS", &id), 0);
+	ASSERT_EQ(id, QCA_NL80211_VENDOR_SUBCMD_DO_ACS);
+	ASSERT_EQ(qca_vendor_subcmd_from_string("ROAMING", &id), 0);
+	ASSERT_EQ(id, QCA_NL80211_VENDOR_SUBCMD_ROAMING);
+	ASSERT_EQ(qca_vendor_subcmd_from_string("NO_SUCH_SUBCMD", &id), -1);
+	
+	ASSERT_STR_EQ(qca_vendor_attr_to_string(QCA_WLAN_VENDOR_ATTR_ANT_RSSI), "ANT_RSSI");
+	ASSERT_NULL(qca_vendor_attr_to_string(QCA_WLAN_VENDOR_ATTR_AFTER_LAST));
+	ASSERT_EQ(qca_vendor_attr_from_string("QCA_WLAN_VENDOR_ATTR_DFS", &id), 0);
+	ASSERT_EQ(id, QCA_WLAN_VENDOR_ATTR_DFS);
+}
+
+TEST_SUITE_BEGIN("Name Table")
+	RUN_TEST(name_table_dense);
+	RUN_TEST(name_table_sparse);
+	RUN_TEST(name_table_find_prefix);
+	RUN_TEST(name_table_concurrent_first_use);
+	RUN_TEST(name_table_wmi_cmds);
+	RUN_TEST(name_table_wmi_log_name_only);
+	RUN_TEST(name_table_vendor);
+TEST_SUITE_END()
@@ -0,0 +1,130 @@
+/* test_namespace_tracker.c - Unit tests for the namespace tracker caches */
+
+#include "test_framework.h"
+#include "namespace_tracker.h"
+#include <string.h>
+#include <sys/stat.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#define TEST_LINKS 3000
+
+struct link_msg {
+	struct nlmsghdr nlh;
+	struct ifinfomsg ifi;
+	char attrs[64];
+};
+
+static struct nlmsghdr *build_link(struct link_msg *msg, uint16_t type, int ifindex,
+                                   const char *ifname)
+{
+	struct rtattr *rta;
+	size_t len = strlen(ifname) + 1;
+	
+	memset(msg, 0, sizeof(*msg));
+	msg->nlh.nlmsg_type = type;
+	msg->ifi.ifi_index = ifindex;
+	
+	rta = (struct rtattr *)msg->attrs;
+	rta->rta_type = IFLA_IFNAME;
+	rta->rta_len = RTA_LENGTH(len);
+	memcpy(RTA_DATA(rta), ifname, len);
+	
+	msg->nlh.nlmsg_len = NLMSG_LENGTH(sizeof(msg->ifi)) + RTA_ALIGN(rta->rta_len);
+	return &msg->nlh;
+}
+
+static ino_t self_nsid(void)
+{
+	struct stat st;
+	
+	if (stat("/proc/self/ns/net", &st) < 0)
+		return 0;
+	return st.st_ino;
+}
+
+TEST(tracker_links_follow_events)
+{
+	struct namespace_tracker *tracker = namespace_tracker_init();
+	struct netns_info info;
+	struct link_msg msg;
+	
+	ASSERT_NOT_NULL(tracker);
+	
+	ASSERT_EQ(namespace_tracker_handle_msg(tracker, build_link(&msg, RTM_NEWLINK, 7, "veth7")), 1);
+	ASSERT_EQ(namespace_tracker_get_by_ifindex(tracker, 7, &info), 0);
+	ASSERT_TRUE(info.valid);
+	ASSERT_EQ(info.nsid, self_nsid());
+	ASSERT_STR_EQ(info.name, "default");
+	
+	ASSERT_EQ(namespace_tracker_handle_msg(tracker, build_link(&msg, RTM_DELLINK, 7, "veth7")), 1);
+	ASSERT_EQ(namespace_tracker_handle_msg(tracker, build_link(&msg, RTM_DELLINK, 7, "veth7")), 0);
+	
+	/* Other messages are not for the tracker */
+	ASSERT_EQ(namespace_tracker_handle_msg(tracker, build_link(&msg, RTM_NEWADDR, 7, "veth7")), 0);
+	msg.nlh.nlmsg_type = RTM_NEWLINK;
+	msg.nlh.nlmsg_len = NLMSG_LENGTH(1);
+	ASSERT_EQ(namespace_tracker_handle_msg(tracker, &msg.nlh), -1);
+	
+	namespace_tracker_destroy(tracker);
+}
+
+TEST(tracker_many_links)
+{
+	struct namespace_tracker *tracker = namespace_tracker_init();
+	struct netns_info info;
+	struct link_msg msg;
+	char ifname[16];
+	
+	ASSERT_NOT_NULL(tracker);
+	
+	/* Enough links to grow the table several times */
+	for (int i = 1; i <= TEST_LINKS; i++) {
+		snprintf(ifname, sizeof(ifname), "veth%d", i);
+		ASSERT_EQ(namespace_tracker_handle_msg(tracker,
+		          build_link(&msg, RTM_NEWLINK, i, ifname)), 1);
+	}
+	
+	/* Remove every other one, the rest stay reachable */
+	for (int i = 1; i <= TEST_LINKS; i += 2)
+		ASSERT_EQ(namespace_tracker_handle_msg(tracker,
+		          build_link(&msg, RTM_DELLINK, i, "")), 1);
+	for (int i = 1; i <= TEST_LINKS; i++) {
+		ASSERT_EQ(namespace_tracker_handle_msg(tracker,
+		          build_link(&msg, RTM_DELLINK, i, "")), i % 2 == 0 ? 1 : 0);
+	}
+	
+	ASSERT_EQ(namespace_tracker_get_by_ifindex(tracker, 2, &info), 0);
+	ASSERT_EQ(namespace_tracker_get_by_ifindex(tracker, -1, &info), -1);
+	
+	namespace_tracker_destroy(tracker);
+}
+
+TEST(tracker_resolves_scanned_namespaces)
+{
+	struct namespace_tracker *tracker = namespace_tracker_init();
+	char name[NAMESPACE_NAME_MAX];
+	
+	ASSERT_NOT_NULL(tracker);
+	
+	/* The scan of /proc finds our own namespace */
+	ASSERT_EQ(namespace_tracker_resolve_name(tracker, self_nsid(), name, sizeof(name)), 0);
+	ASSERT_TRUE(name[0] != '\0');
+	
+	ASSERT_EQ(namespace_tracker_resolve_name(tracker, 1, name, sizeof(name)), -1);
+	ASSERT_STR_EQ(name, "ns-1");
+	
+	/* Netns events only schedule a rescan */
+	struct nlmsghdr nsid_msg = { .nlmsg_len = NLMSG_LENGTH(0), .nlmsg_type = RTM_NEWNSID };
+	ASSERT_EQ(namespace_tracker_handle_msg(tracker, &nsid_msg), 0);
+	namespace_tracker_update_cache(tracker);
+	ASSERT_EQ(namespace_tracker_resolve_name(tracker, self_nsid(), name, sizeof(name)), 0);
+	
+	namespace_tracker_destroy(tracker);
+}
+
+TEST_SUITE_BEGIN("Namespace Tracker")
+	RUN_TEST(tracker_links_follow_events);
+	RUN_TEST(tracker_many_links);
+	RUN_TEST(tracker_resolves_scanned_namespaces);
+TEST_SUITE_END()
@@ -0,0 +1,206 @@
+/* test_netlink_compat.c - Unit tests for the netlink compatibility layer fast paths */
+
+#include "test_framework.h"
+#include "event_processor.h"
+#include "nlmon_netlink.h"
+#include "nlmon_netlink_compat.h"
+#include "nlmon_nl_diag.h"
+#include <stdio.h>
+#include <string.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+struct seen {
+	int events;
+	nlmon_event_type_t type;
+	uint16_t family_id;
+	char family_name[32];
+	struct nlmsghdr *nlh;
+};
+
+static void legacy_cb(nlmon_event_type_t type, void *data, void *user_data)
+{
+	struct seen *s = user_data;
+
+	s->events++;
+	s->type = type;
+	if (type == NLMON_EVENT_GENERIC) {
+		const struct nlmon_generic_msg *msg = data;
+
+		s->family_id = msg->family_id;
+		strcpy(s->family_name, msg->family_name);
+	} else {
+		s->nlh = data;
+	}
+}
+
+/* Reads the raw message only, never the legacy structures */
+static void view_cb(nlmon_event_type_t type, struct nlmon_compat_view *view, void *user_data)
+{
+	struct seen *s = user_data;
+
+	s->events++;
+	s->type = type;
+	s->nlh = nlmon_compat_view_nlmsg(view);
+}
+
+/* Reads the generic structure twice */
+static void view_generic_cb(nlmon_event_type_t type, struct nlmon_compat_view *view,
+                            void *user_data)
+{
+	struct seen *s = user_data;
+	const struct nlmon_generic_msg *msg = nlmon_compat_view_generic(view);
+
+	s->events++;
+	s->type = type;
+	if (msg && nlmon_compat_view_generic(view) == msg) {
+		s->family_id = msg->family_id;
+		strcpy(s->family_name, msg->family_name);
+	}
+	/* Not a socket event */
+	if (nlmon_compat_view_sock_diag(view))
+		s->events = -1;
+}
+
+static void native_cb(struct nlmon_event *evt, void *user_data)
+{
+	struct seen *s = user_data;
+
+	(void)evt;
+	s->events++;
+}
+
+static void make_generic(struct nlmon_event *evt)
+{
+	memset(evt, 0, sizeof(*evt));
+	evt->netlink.protocol = NETLINK_GENERIC;
+	evt->netlink.genl_family_id = 0x1c;
+	strcpy(evt->netlink.genl_family_name, "nl80211");
+}
+
+static void make_route(struct nlmon_event *evt, struct nlmsghdr *nlh)
+{
+	memset(evt, 0, sizeof(*evt));
+	memset(nlh, 0, sizeof(*nlh));
+	nlh->nlmsg_type = RTM_NEWLINK;
+	evt->netlink.protocol = NETLINK_ROUTE;
+	evt->netlink.msg_type = RTM_NEWLINK;
+	evt->raw_msg = nlh;
+}
+
+TEST(compat_legacy_callback)
+{
+	struct nlmon_multi_protocol_ctx *ctx = nlmon_multi_protocol_init_compat();
+	struct nlmon_multi_protocol_ctx_compat *cc = (struct nlmon_multi_protocol_ctx_compat *)ctx;
+	struct nlmon_compat_stats stats;
+	struct nlmon_event evt;
+	struct nlmsghdr nlh;
+	struct seen s;
+
+	ASSERT_NOT_NULL(ctx);
+	memset(&s, 0, sizeof(s));
+	nlmon_multi_protocol_set_callback_compat(ctx, legacy_cb, &s);
+
+	/* Generic events are converted up front */
+	make_generic(&evt);
+	nlmon_compat_event_translator(&evt, cc);
+	ASSERT_EQ(s.events, 1);
+	ASSERT_EQ(s.type, NLMON_EVENT_GENERIC);
+	ASSERT_EQ(s.family_id, 0x1c);
+	ASSERT_STR_EQ(s.family_name, "nl80211");
+
+	/* Route events pass the message as is */
+	make_route(&evt, &nlh);
+	nlmon_compat_event_translator(&evt, cc);
+	ASSERT_EQ(s.events, 2);
+	ASSERT_EQ(s.type, NLMON_EVENT_LINK);
+	ASSERT_TRUE(s.nlh == &nlh);
+
+	/* Socket events without data are not reported */
+	memset(&evt, 0, sizeof(evt));
+	evt.netlink.protocol = NETLINK_SOCK_DIAG;
+	nlmon_compat_event_translator(&evt, cc);
+	ASSERT_EQ(s.events, 2);
+
+	nlmon_compat_get_stats(ctx, &stats);
+	ASSERT_EQ(stats.legacy_events, 2);
+	ASSERT_EQ(stats.conversions, 1);
+	ASSERT_TRUE(stats.conversions_per_sec > 0.0);
+	ASSERT_EQ(stats.native, 0);
+
+	nlmon_multi_protocol_destroy_compat(ctx);
+}
+
+TEST(compat_lazy_view)
+{
+	struct nlmon_multi_protocol_ctx *ctx = nlmon_multi_protocol_init_compat();
+	struct nlmon_multi_protocol_ctx_compat *cc = (struct nlmon_multi_protocol_ctx_compat *)ctx;
+	struct nlmon_compat_stats stats;
+	struct nlmon_event evt;
+	struct nlmsghdr nlh;
+	struct seen s;
+
+	ASSERT_NOT_NULL(ctx);
+	memset(&s, 0, sizeof(s));
+
+	/* Nothing read, nothing converted */
+	nlmon_multi_protocol_set_view_callback_compat(ctx, view_cb, &s);
+	make_generic(&evt);
+	nlmon_compat_event_translator(&evt, cc);
+	make_route(&evt, &nlh);
+	nlmon_compat_event_translator(&evt, cc);
+	ASSERT_EQ(s.events, 2);
+	ASSERT_TRUE(s.nlh == &nlh);
+
+	nlmon_compat_get_stats(ctx, &stats);
+	ASSERT_EQ(stats.legacy_events, 2);
+	ASSERT_EQ(stats.conversions, 0);
+
+	/* Read twice, converted once */
+	nlmon_multi_protocol_set_view_callback_compat(ctx, view_generic_cb, &s);
+	make_generic(&evt);
+	nlmon_compat_event_translator(&evt, cc);
+	ASSERT_EQ(s.events, 3);
+	ASSERT_EQ(s.family_id, 0x1c);
+	ASSERT_STR_EQ(s.family_name, "nl80211");
+
+	nlmon_compat_get_stats(ctx, &stats);
+	ASSERT_EQ(stats.conversions, 1);
+
+	nlmon_multi_protocol_destroy_compat(ctx);
+}
+
+TEST(compat_native_bypass)
+{
+	struct nlmon_multi_protocol_ctx *ctx = nlmon_multi_protocol_init_compat();
+	struct nlmon_multi_protocol_ctx_compat *cc = (struct nlmon_multi_protocol_ctx_compat *)ctx;
+	struct nlmon_compat_stats stats;
+	struct seen s;
+
+	ASSERT_NOT_NULL(ctx);
+	memset(&s, 0, sizeof(s));
+
+	/* The manager calls the handler itself */
+	nlmon_multi_protocol_set_event_handler_compat(ctx, native_cb, &s);
+	ASSERT_TRUE(cc->nl_mgr->event_callback == native_cb);
+	ASSERT_TRUE(cc->nl_mgr->user_data == &s);
+
+	nlmon_compat_get_stats(ctx, &stats);
+	ASSERT_EQ(stats.native, 1);
+
+	/* A legacy callback brings the translator back */
+	nlmon_multi_protocol_set_callback_compat(ctx, legacy_cb, &s);
+	ASSERT_TRUE(cc->nl_mgr->event_callback == nlmon_compat_event_translator);
+	ASSERT_TRUE(cc->nl_mgr->user_data == cc);
+
+	nlmon_compat_get_stats(ctx, &stats);
+	ASSERT_EQ(stats.native, 0);
+
+	nlmon_multi_protocol_destroy_compat(ctx);
+}
+
+TEST_SUITE_BEGIN("Netlink Compatibility Layer")
+	RUN_TEST(compat_legacy_callback);
+	RUN_TEST(compat_lazy_view);
+	RUN_TEST(compat_native_bypass);
+TEST_SUITE_END()
@@ -0,0 +1,215 @@
+/* test_nl_cache.c - Unit tests for identity-indexed libnl caches */
+
+#include "test_framework.h"
+#include "nlmon_netlink.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <netlink/netlink.h>
+#include <netlink/msg.h>
+#include <netlink/attr.h>
+#include <netlink/cache.h>
+#include <netlink/cache-api.h>
+
+#define TEST_MSG_NEW 0x7f0
+#define TEST_MSG_DEL 0x7f1
+#define TEST_ATTR_ID 0x1
+
+struct test_obj {
+	NLHDR_COMMON
+	int id;
+	int value;
+};
+
+static int keygen_calls;
+
+static uint32_t test_keygen(struct nl_object *obj)
+{
+	keygen_calls++;
+	return ((struct test_obj *)obj)->id * 2654435761u;
+}
+
+static int test_compare(struct nl_object *a, struct nl_object *b, uint32_t attrs, int flags)
+{
+	(void)flags;
+	return (attrs & TEST_ATTR_ID) &&
+	       ((struct test_obj *)a)->id != ((struct test_obj *)b)->id ? TEST_ATTR_ID : 0;
+}
+
+static struct nl_object_ops test_obj_ops = {
+	.oo_name = "test/obj",
+	.oo_size = sizeof(struct test_obj),
+	.oo_id_attrs = TEST_ATTR_ID,
+	.oo_compare = test_compare,
+	.oo_keygen = test_keygen,
+};
+
+static struct nl_cache_ops test_cache_ops = {
+	.co_name = "test/obj",
+	.co_protocol = NETLINK_USERSOCK,
+	.co_hdrsize = 0,
+	.co_obj_ops = &test_obj_ops,
+	.co_msgtypes = {
+		{ TEST_MSG_NEW, NL_ACT_NEW, "new" },
+		{ TEST_MSG_DEL, NL_ACT_DEL, "del" },
+		END_OF_MSGTYPES_LIST,
+	},
+};
+
+static int changes[NL_ACT_MAX + 1];
+
+static void count_change(struct nl_cache *cache, struct nl_object *obj, int action)
+{
+	(void)cache;
+	(void)obj;
+	changes[action]++;
+}
+
+static struct nl_object *test_obj(int msgtype, int id, int value)
+{
+	struct test_obj *obj = (struct test_obj *)nl_object_alloc(&test_obj_ops);
+
+	obj->ce_msgtype = msgtype;
+	obj->ce_mask = TEST_ATTR_ID;
+	obj->id = id;
+	obj->value = value;
+	return (struct nl_object *)obj;
+}
+
+TEST(nl_cache_search_hashed)
+{
+	struct nl_cache *cache = nl_cache_alloc(&test_cache_ops);
+	struct nl_object *obj, *found;
+	int i;
+
+	ASSERT_NOT_NULL(cache);
+	for (i = 0; i < 2000; i++) {
+		obj = test_obj(TEST_MSG_NEW, i, i);
+		ASSERT_EQ(nl_cache_add(cache, obj), 0);
+		nl_object_put(obj);
+	}
+	ASSERT_EQ(nl_cache_nitems(cache), 2000);
+
+	/* One bucket per lookup, not a walk over the cache */
+	obj = test_obj(TEST_MSG_NEW, 1234, 0);
+	keygen_calls = 0;
+	found = nl_cache_search(cache, obj);
+	ASSERT_NOT_NULL(found);
+	ASSERT_EQ(((struct test_obj *)found)->value, 1234);
+	ASSERT_EQ(keygen_calls, 1);
+
+	nl_cache_remove(found);
+	ASSERT_NULL(nl_cache_search(cache, obj));
+	ASSERT_EQ(nl_cache_nitems(cache), 1999);
+	nl_object_put(obj);
+
+	nl_cache_free(cache);
+}
+
+TEST(nl_cache_include_actions)
+{
+	struct nl_cache *cache = nl_cache_alloc(&test_cache_ops);
+	struct nl_object *obj, *needle;
+
+	memset(changes, 0, sizeof(changes));
+
+	obj = test_obj(TEST_MSG_NEW, 7, 1);
+	ASSERT_EQ(nl_cache_include(cache, obj, count_change), 0);
+	nl_object_put(obj);
+	ASSERT_EQ(changes[NL_ACT_NEW], 1);
+
+	/* Same identity replaces */
+	obj = test_obj(TEST_MSG_NEW, 7, 2);
+	ASSERT_EQ(nl_cache_include(cache, obj, count_change), 0);
+	nl_object_put(obj);
+	ASSERT_EQ(changes[NL_ACT_CHANGE], 1);
+	ASSERT_EQ(nl_cache_nitems(cache), 1);
+
+	needle = test_obj(TEST_MSG_NEW, 7, 0);
+	ASSERT_EQ(((struct test_obj *)nl_cache_search(cache, needle))->value, 2);
+
+	obj = test_obj(TEST_MSG_DEL, 7, 0);
+	ASSERT_EQ(nl_cache_include(cache, obj, count_change), 0);
+	nl_object_put(obj);
+	ASSERT_EQ(changes[NL_ACT_DEL], 1);
+	ASSERT_EQ(nl_cache_nitems(cache), 0);
+	ASSERT_NULL(nl_cache_search(cache, needle));
+	nl_object_put(needle);
+
+	obj = test_obj(0x7f2, 8, 0);
+	ASSERT_EQ(nl_cache_include(cache, obj, NULL), -NLE_MSGTYPE_NOSUPPORT);
+	nl_object_put(obj);
+
+	nl_cache_free(cache);
+}
+
+TEST(nl_cache_msgtype_table)
+{
+	struct nl_msgtype *mt;
+
+	/* Unregistered operations fall back to their own list */
+	mt = nl_msgtype_lookup(&test_cache_ops, TEST_MSG_DEL);
+	ASSERT_NOT_NULL(mt);
+	ASSERT_EQ(mt->mt_act, NL_ACT_DEL);
+	ASSERT_NULL(nl_cache_ops_associate(NETLINK_USERSOCK, TEST_MSG_NEW));
+
+	ASSERT_EQ(nl_cache_mngt_register(&test_cache_ops), 0);
+	ASSERT_TRUE(nl_cache_ops_associate(NETLINK_USERSOCK, TEST_MSG_NEW) == &test_cache_ops);
+	ASSERT_NULL(nl_cache_ops_associate(NETLINK_ROUTE, TEST_MSG_NEW));
+	ASSERT_TRUE(nl_msgtype_lookup(&test_cache_ops, TEST_MSG_NEW) ==
+	            &test_cache_ops.co_msgtypes[0]);
+	ASSERT_NULL(nl_msgtype_lookup(&test_cache_ops, 0x7f2));
+
+	ASSERT_EQ(nl_cache_mngt_unregister(&test_cache_ops), 0);
+	ASSERT_NULL(nl_cache_ops_associate(NETLINK_USERSOCK, TEST_MSG_NEW));
+}
+
+static struct nl_msg *link_msg(int type, int ifindex)
+{
+	struct nl_msg *msg = nlmsg_alloc_simple(type, 0);
+	struct ifinfomsg ifi;
+
+	memset(&ifi, 0, sizeof(ifi));
+	ifi.ifi_index = ifindex;
+	nlmsg_append(msg, &ifi, sizeof(ifi), NLMSG_ALIGNTO);
+	nla_put(msg, IFLA_IFNAME, sizeof("test0"), "test0");
+	return msg;
+}
+
+TEST(nl_cache_manager_link)
+{
+	struct nlmon_nl_manager *mgr = nlmon_nl_manager_init();
+	struct nl_msg *msg;
+
+	ASSERT_NOT_NULL(mgr);
+	ASSERT_EQ(nlmon_nl_enable_route(mgr), 0);
+	ASSERT_EQ(nlmon_nl_cache_init_link(mgr), 0);
+
+	/* The dump reply is never read, only these reach the cache */
+	msg = link_msg(RTM_NEWLINK, 100000);
+	ASSERT_EQ(nlmon_nl_cache_update_link(mgr, msg), 0);
+	ASSERT_EQ(nlmon_nl_cache_update_link(mgr, msg), 0);
+	nlmsg_free(msg);
+	ASSERT_EQ(nlmon_nl_get_link_count(mgr), 1);
+
+	msg = link_msg(RTM_NEWLINK, 100001);
+	ASSERT_EQ(nlmon_nl_cache_update_link(mgr, msg), 0);
+	nlmsg_free(msg);
+	ASSERT_EQ(nlmon_nl_get_link_count(mgr), 2);
+
+	msg = link_msg(RTM_DELLINK, 100000);
+	ASSERT_EQ(nlmon_nl_cache_update_link(mgr, msg), 0);
+	nlmsg_free(msg);
+	ASSERT_EQ(nlmon_nl_get_link_count(mgr), 1);
+
+	nlmon_nl_manager_destroy(mgr);
+}
+
+TEST_SUITE_BEGIN("Netlink Cache Index")
+	RUN_TEST(nl_cache_search_hashed);
+	RUN_TEST(nl_cache_include_actions);
+	RUN_TEST(nl_cache_msgtype_table);
+	RUN_TEST(nl_cache_manager_link);
+TEST_SUITE_END()
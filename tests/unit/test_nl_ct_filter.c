@@ -0,0 +1,227 @@
+/* test_nl_ct_filter.c - Unit tests for kernel-side conntrack event narrowing */
+
+#include "test_framework.h"
+#include "nlmon_netlink.h"
+#include "nlmon_nl_netfilter.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <linux/netlink.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+
+/* Connection of a fake conntrack event */
+struct ct_conn {
+	uint8_t family;
+	uint8_t l4proto;
+	int zone;                        /* -1 to leave CTA_ZONE out */
+	uint32_t mark;                   /* 0 to leave CTA_MARK out */
+};
+
+static struct nlattr *put_attr(uint8_t *buf, size_t *len, uint16_t type,
+                               const void *data, size_t size)
+{
+	struct nlattr *nla = (struct nlattr *)(buf + *len);
+
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + size;
+	if (data)
+		memcpy(buf + *len + NLA_HDRLEN, data, size);
+	*len += NLA_ALIGN(nla->nla_len);
+	return nla;
+}
+
+/* Build an IPCTNL_MSG_CT_NEW message of @subsys, returns its length */
+static size_t build_event(uint8_t *buf, uint8_t subsys, const struct ct_conn *conn)
+{
+	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+	struct nfgenmsg *nfg = (struct nfgenmsg *)(buf + NLMSG_HDRLEN);
+	struct nlattr *orig, *proto;
+	size_t len = NLMSG_HDRLEN + NLMSG_ALIGN(sizeof(*nfg));
+	size_t orig_start, proto_start;
+
+	memset(buf, 0, 256);
+	nlh->nlmsg_type = (subsys << 8) | IPCTNL_MSG_CT_NEW;
+	nlh->nlmsg_pid = 0;
+	nfg->nfgen_family = conn->family;
+	nfg->version = NFNETLINK_V0;
+
+	orig_start = len;
+	orig = put_attr(buf, &len, CTA_TUPLE_ORIG | NLA_F_NESTED, NULL, 0);
+	proto_start = len;
+	proto = put_attr(buf, &len, CTA_TUPLE_PROTO | NLA_F_NESTED, NULL, 0);
+	put_attr(buf, &len, CTA_PROTO_NUM, &conn->l4proto, 1);
+	proto->nla_len = len - proto_start;
+	orig->nla_len = len - orig_start;
+
+	if (conn->mark) {
+		uint32_t mark = htonl(conn->mark);
+
+		put_attr(buf, &len, CTA_MARK, &mark, sizeof(mark));
+	}
+	if (conn->zone >= 0) {
+		uint16_t zone = htons(conn->zone);
+
+		put_attr(buf, &len, CTA_ZONE, &zone, sizeof(zone));
+	}
+
+	nlh->nlmsg_len = len;
+	return len;
+}
+
+/* Socket pair whose receiving end runs the compiled filter */
+static int attach_pair(const struct nlmon_ct_filter *filter, int fds[2])
+{
+	struct sock_filter insns[NLMON_CT_FILTER_MAX_INSNS + 1];
+	struct sock_fprog fprog;
+	int len;
+
+	len = nlmon_ct_filter_compile(filter, insns, NLMON_CT_FILTER_MAX_INSNS);
+	if (len <= 0)
+		return -1;
+	insns[len] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) < 0)
+		return -1;
+
+	fprog.len = len + 1;
+	fprog.filter = insns;
+	if (setsockopt(fds[1], SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	return 0;
+}
+
+/* Whether an event sent through the pair gets past the filter */
+static int passes(int fds[2], uint8_t subsys, const struct ct_conn *conn)
+{
+	uint8_t buf[256], rbuf[256];
+	size_t len = build_event(buf, subsys, conn);
+
+	if (send(fds[0], buf, len, 0) != (ssize_t)len)
+		return -1;
+	return recv(fds[1], rbuf, sizeof(rbuf), MSG_DONTWAIT) == (ssize_t)len;
+}
+
+TEST(ct_filter_compile_limits)
+{
+	struct nlmon_ct_filter filter = {
+		.l3proto = AF_INET, .l4proto = IPPROTO_TCP,
+		.match_zone = true, .zone = 7, .mark = 1, .mark_mask = 0xff,
+	};
+	struct sock_filter insns[NLMON_CT_FILTER_MAX_INSNS];
+	int len;
+
+	/* Everything fits the documented bound */
+	len = nlmon_ct_filter_compile(&filter, insns, NLMON_CT_FILTER_MAX_INSNS);
+	ASSERT_TRUE(len > 0 && len <= NLMON_CT_FILTER_MAX_INSNS);
+	ASSERT_EQ(nlmon_ct_filter_compile(&filter, insns, 4), -ENOSPC);
+
+	/* Ends with the reject its jumps lead to */
+	ASSERT_EQ(insns[len - 1].code, BPF_RET | BPF_K);
+	ASSERT_EQ(insns[len - 1].k, 0);
+
+	/* No condition means no program */
+	memset(&filter, 0, sizeof(filter));
+	filter.events = NLMON_CT_EVENT_DESTROY;
+	ASSERT_EQ(nlmon_ct_filter_compile(&filter, insns, NLMON_CT_FILTER_MAX_INSNS), 0);
+
+	filter.l3proto = AF_UNIX;
+	ASSERT_EQ(nlmon_ct_filter_compile(&filter, insns, NLMON_CT_FILTER_MAX_INSNS), -EINVAL);
+}
+
+TEST(ct_filter_kernel_match)
+{
+	struct nlmon_ct_filter filter = {
+		.l3proto = AF_INET, .l4proto = IPPROTO_TCP,
+		.match_zone = true, .zone = 7, .mark = 0x10, .mark_mask = 0xf0,
+	};
+	struct ct_conn conn = { AF_INET, IPPROTO_TCP, 7, 0x1f };
+	struct ct_conn other;
+	int fds[2];
+
+	ASSERT_EQ(attach_pair(&filter, fds), 0);
+
+	ASSERT_EQ(passes(fds, NFNL_SUBSYS_CTNETLINK, &conn), 1);
+
+	other = conn;
+	other.family = AF_INET6;
+	ASSERT_EQ(passes(fds, NFNL_SUBSYS_CTNETLINK, &other), 0);
+
+	other = conn;
+	other.l4proto = IPPROTO_UDP;
+	ASSERT_EQ(passes(fds, NFNL_SUBSYS_CTNETLINK, &other), 0);
+
+	other = conn;
+	other.zone = 8;
+	ASSERT_EQ(passes(fds, NFNL_SUBSYS_CTNETLINK, &other), 0);
+
+	other = conn;
+	other.mark = 0x21;
+	ASSERT_EQ(passes(fds, NFNL_SUBSYS_CTNETLINK, &other), 0);
+
+	/* Other subsystems pass untouched */
+	ASSERT_EQ(passes(fds, NFNL_SUBSYS_CTNETLINK_EXP + 1, &other), 1);
+
+	close(fds[0]);
+	close(fds[1]);
+}
+
+TEST(ct_filter_missing_attrs)
+{
+	struct nlmon_ct_filter filter = { .match_zone = true, .zone = 0, .mark_mask = 0xffffffff };
+	struct ct_conn conn = { AF_INET, IPPROTO_UDP, -1, 0 };
+	int fds[2];
+
+	/* Conntrack leaves zone 0 and mark 0 out, they still match */
+	ASSERT_EQ(attach_pair(&filter, fds), 0);
+	ASSERT_EQ(passes(fds, NFNL_SUBSYS_CTNETLINK, &conn), 1);
+
+	conn.mark = 5;
+	ASSERT_EQ(passes(fds, NFNL_SUBSYS_CTNETLINK, &conn), 0);
+
+	conn.mark = 0;
+	conn.zone = 3;
+	ASSERT_EQ(passes(fds, NFNL_SUBSYS_CTNETLINK, &conn), 0);
+
+	close(fds[0]);
+	close(fds[1]);
+}
+
+TEST(ct_filter_manager)
+{
+	struct nlmon_nl_manager *mgr = nlmon_nl_manager_init();
+	struct nlmon_ct_filter filter = { .events = NLMON_CT_EVENT_DESTROY, .l4proto = IPPROTO_TCP };
+
+	ASSERT_NOT_NULL(mgr);
+	ASSERT_EQ(mgr->ct_events, NLMON_CT_EVENT_ALL);
+
+	/* Kept until the socket opens */
+	ASSERT_EQ(nlmon_nl_set_ct_filter(mgr, &filter), 0);
+	ASSERT_EQ(mgr->ct_events, NLMON_CT_EVENT_DESTROY);
+	ASSERT_NOT_NULL(mgr->ct_prog);
+
+	filter.events = 1u << 5;
+	ASSERT_EQ(nlmon_nl_set_ct_filter(mgr, &filter), -EINVAL);
+	ASSERT_EQ(mgr->ct_events, NLMON_CT_EVENT_DESTROY);
+
+	ASSERT_EQ(nlmon_nl_set_ct_filter(mgr, NULL), 0);
+	ASSERT_EQ(mgr->ct_events, NLMON_CT_EVENT_ALL);
+	ASSERT_NULL(mgr->ct_prog);
+
+	nlmon_nl_manager_destroy(mgr);
+}
+
+TEST_SUITE_BEGIN("Netlink Conntrack Filter")
+	RUN_TEST(ct_filter_compile_limits);
+	RUN_TEST(ct_filter_kernel_match);
+	RUN_TEST(ct_filter_missing_attrs);
+	RUN_TEST(ct_filter_manager);
+TEST_SUITE_END()
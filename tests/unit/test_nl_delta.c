@@ -0,0 +1,240 @@
+/* test_nl_delta.c - Unit tests for suppression of repeated netlink updates */
+
+#include "test_framework.h"
+#include "nlmon_nl_delta.h"
+#include "nlmon_nl_route.h"
+#include "event_processor.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
+
+static void make_link(struct nlmon_event *event, struct nlmon_link_info *link,
+                      uint16_t type, int ifindex, unsigned int flags, int operstate)
+{
+	memset(event, 0, sizeof(*event));
+	memset(link, 0, sizeof(*link));
+	snprintf(link->ifname, sizeof(link->ifname), "eth%d", ifindex);
+	link->ifindex = ifindex;
+	link->flags = flags;
+	link->mtu = 1500;
+	link->operstate = operstate;
+	event->netlink.protocol = NETLINK_ROUTE;
+	event->netlink.msg_type = type;
+	event->message_type = type;
+	event->netlink.data.link = link;
+}
+
+TEST(delta_link_repeats_dropped)
+{
+	struct nlmon_nl_delta_stats stats;
+	struct nlmon_nl_delta *delta;
+	struct nlmon_link_info link;
+	struct nlmon_event event;
+	
+	delta = nlmon_nl_delta_create(0);
+	ASSERT_NOT_NULL(delta);
+	
+	make_link(&event, &link, RTM_NEWLINK, 2, IFF_UP, 6);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 0);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 0);
+	
+	/* Another link is another object */
+	make_link(&event, &link, RTM_NEWLINK, 3, IFF_UP, 6);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	
+	/* A changed flag goes through once */
+	make_link(&event, &link, RTM_NEWLINK, 2, IFF_UP | IFF_RUNNING, 6);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 0);
+	
+	/* Other protocols are not looked at */
+	event.netlink.protocol = NETLINK_GENERIC;
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	
+	nlmon_nl_delta_get_stats(delta, &stats);
+	ASSERT_EQ(stats.kinds[NLMON_NL_DELTA_LINK].changed, 3);
+	ASSERT_EQ(stats.kinds[NLMON_NL_DELTA_LINK].heartbeats, 3);
+	ASSERT_EQ(stats.objects, 2);
+	
+	nlmon_nl_delta_destroy(delta);
+}
+
+TEST(delta_field_mask)
+{
+	struct nlmon_nl_delta *delta;
+	struct nlmon_link_info link;
+	struct nlmon_event event;
+	
+	delta = nlmon_nl_delta_create(0);
+	ASSERT_EQ(nlmon_nl_delta_set_fields(delta, NLMON_NL_DELTA_LINK, NLMON_NL_DELTA_LINK_FLAGS), 0);
+	ASSERT_EQ(nlmon_nl_delta_set_fields(delta, NLMON_NL_DELTA_KIND_COUNT, 0), -EINVAL);
+	
+	/* Operstate does not count any more */
+	make_link(&event, &link, RTM_NEWLINK, 2, IFF_UP, 6);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	make_link(&event, &link, RTM_NEWLINK, 2, IFF_UP, 2);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 0);
+	make_link(&event, &link, RTM_NEWLINK, 2, 0, 2);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	
+	/* A new mask lets each object through once more */
+	nlmon_nl_delta_set_fields(delta, NLMON_NL_DELTA_LINK, NLMON_NL_DELTA_ALL_FIELDS);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 0);
+	
+	/* No fields, no suppression */
+	nlmon_nl_delta_set_fields(delta, NLMON_NL_DELTA_LINK, 0);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	
+	nlmon_nl_delta_destroy(delta);
+}
+
+TEST(delta_del_forgets_object)
+{
+	struct nlmon_nl_delta_stats stats;
+	struct nlmon_nl_delta *delta;
+	struct nlmon_link_info link;
+	struct nlmon_event event;
+	
+	delta = nlmon_nl_delta_create(0);
+	
+	make_link(&event, &link, RTM_NEWLINK, 2, IFF_UP, 6);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	make_link(&event, &link, RTM_DELLINK, 2, IFF_UP, 6);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	
+	nlmon_nl_delta_get_stats(delta, &stats);
+	ASSERT_EQ(stats.objects, 0);
+	
+	/* Recreated with the same state it is new again */
+	make_link(&event, &link, RTM_NEWLINK, 2, IFF_UP, 6);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	
+	nlmon_nl_delta_clear(delta);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	
+	nlmon_nl_delta_destroy(delta);
+}
+
+TEST(delta_heartbeat)
+{
+	struct nlmon_nl_delta_stats stats;
+	struct nlmon_nl_delta *delta;
+	struct nlmon_link_info link;
+	struct nlmon_event event;
+	
+	delta = nlmon_nl_delta_create(0);
+	nlmon_nl_delta_set_heartbeat(delta, 1);
+	
+	make_link(&event, &link, RTM_NEWLINK, 2, IFF_UP, 6);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 0);
+	
+	usleep(1100000);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 0);
+	
+	nlmon_nl_delta_get_stats(delta, &stats);
+	ASSERT_EQ(stats.kinds[NLMON_NL_DELTA_LINK].heartbeats, 2);
+	ASSERT_EQ(stats.kinds[NLMON_NL_DELTA_LINK].heartbeats_passed, 1);
+	
+	nlmon_nl_delta_destroy(delta);
+}
+
+TEST(delta_table_full)
+{
+	struct nlmon_nl_delta_stats stats;
+	struct nlmon_nl_delta *delta;
+	struct nlmon_link_info link;
+	struct nlmon_event event;
+	int i;
+	
+	delta = nlmon_nl_delta_create(4);
+	
+	for (i = 1; i <= 6; i++) {
+		make_link(&event, &link, RTM_NEWLINK, i, IFF_UP, 6);
+		ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	}
+	
+	/* Untracked objects are never suppressed */
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	make_link(&event, &link, RTM_NEWLINK, 1, IFF_UP, 6);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 0);
+	
+	nlmon_nl_delta_get_stats(delta, &stats);
+	ASSERT_EQ(stats.objects, 4);
+	ASSERT_EQ(stats.kinds[NLMON_NL_DELTA_LINK].untracked, 3);
+	
+	nlmon_nl_delta_destroy(delta);
+}
+
+TEST(delta_route_and_neigh)
+{
+	struct nlmon_nl_delta *delta;
+	struct nlmon_route_info route;
+	struct nlmon_neigh_info neigh;
+	struct nlmon_event event;
+	
+	delta = nlmon_nl_delta_create(0);
+	
+	memset(&event, 0, sizeof(event));
+	memset(&route, 0, sizeof(route));
+	route.family = AF_INET;
+	route.dst_len = 24;
+	route.table = RT_TABLE_MAIN;
+	strcpy(route.dst, "10.0.0.0");
+	strcpy(route.gateway, "192.168.1.1");
+	route.oif = 2;
+	event.netlink.protocol = NETLINK_ROUTE;
+	event.netlink.msg_type = RTM_NEWROUTE;
+	event.netlink.data.route = &route;
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 0);
+	
+	/* Same prefix in another table is another route */
+	route.table = 100;
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	strcpy(route.gateway, "192.168.1.2");
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	
+	memset(&event, 0, sizeof(event));
+	memset(&neigh, 0, sizeof(neigh));
+	neigh.family = AF_INET;
+	neigh.ifindex = 2;
+	neigh.state = NUD_REACHABLE;
+	strcpy(neigh.dst, "192.168.1.1");
+	memcpy(neigh.lladdr, "\x02\x00\x00\x00\x00\x01", 6);
+	event.netlink.protocol = NETLINK_ROUTE;
+	event.netlink.msg_type = RTM_NEWNEIGH;
+	event.netlink.data.neigh = &neigh;
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 0);
+	
+	/* Only the state counts, lladdr changes are left to the detectors */
+	nlmon_nl_delta_set_fields(delta, NLMON_NL_DELTA_NEIGH, NLMON_NL_DELTA_NEIGH_STATE);
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	neigh.lladdr[5] = 2;
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 0);
+	neigh.state = NUD_STALE;
+	ASSERT_EQ(nlmon_nl_delta_check(delta, &event), 1);
+	
+	nlmon_nl_delta_destroy(delta);
+}
+
+TEST_SUITE_BEGIN("Netlink Delta")
+	RUN_TEST(delta_link_repeats_dropped);
+	RUN_TEST(delta_field_mask);
+	RUN_TEST(delta_del_forgets_object);
+	RUN_TEST(delta_heartbeat);
+	RUN_TEST(delta_table_full);
+	RUN_TEST(delta_route_and_neigh);
+TEST_SUITE_END()
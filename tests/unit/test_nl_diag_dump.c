@@ -0,0 +1,248 @@
+/* test_nl_diag_dump.c - Unit tests for filtered, incremental socket diagnostics dumps */
+
+#include "test_framework.h"
+#include "nlmon_nl_diag_dump.h"
+#include "nlmon_nl_diag.h"
+#include "event_processor.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/inet_diag.h>
+
+struct changes {
+	int count[4];                    /* Per enum nlmon_diag_change */
+	uint8_t last_state;
+	uint16_t last_port;
+};
+
+static void collect(struct nlmon_event *evt, void *ctx)
+{
+	struct changes *c = ctx;
+	struct nlmon_diag_info *info = evt->netlink.data.diag;
+	
+	if (info->change < 4)
+		c->count[info->change]++;
+	c->last_state = info->state;
+	c->last_port = info->src_port;
+}
+
+static int listen_loopback(uint16_t *port)
+{
+	struct sockaddr_in sin = { .sin_family = AF_INET };
+	socklen_t len = sizeof(sin);
+	int fd;
+	
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 || listen(fd, 4) < 0 ||
+	    getsockname(fd, (struct sockaddr *)&sin, &len) < 0) {
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	
+	*port = ntohs(sin.sin_port);
+	return fd;
+}
+
+TEST(diag_compile_single_filter)
+{
+	struct nlmon_diag_filter filter = { .protocol = IPPROTO_TCP, .sport_min = 80, .sport_max = 80 };
+	uint8_t bc[256];
+	struct inet_diag_bc_op *op = (struct inet_diag_bc_op *)bc;
+	
+	ASSERT_EQ(nlmon_diag_compile_filters(&filter, 1, AF_INET, IPPROTO_TCP, bc, sizeof(bc)), 16);
+	
+	/* Both comparisons reject past the end */
+	ASSERT_EQ(op[0].code, INET_DIAG_BC_S_GE);
+	ASSERT_EQ(op[0].yes, 8);
+	ASSERT_EQ(op[0].no, 20);
+	ASSERT_EQ(op[1].no, 80);
+	ASSERT_EQ(op[2].code, INET_DIAG_BC_S_LE);
+	ASSERT_EQ(op[2].no, 12);
+	ASSERT_EQ(op[3].no, 80);
+	
+	/* A filter of another protocol or family does not apply */
+	ASSERT_EQ(nlmon_diag_compile_filters(&filter, 1, AF_INET, IPPROTO_UDP, bc, sizeof(bc)), -ENOENT);
+	strcpy(filter.src, "10.0.0.0");
+	filter.src_len = 8;
+	ASSERT_EQ(nlmon_diag_compile_filters(&filter, 1, AF_INET6, IPPROTO_TCP, bc, sizeof(bc)), -ENOENT);
+	ASSERT_EQ(nlmon_diag_compile_filters(&filter, 1, AF_INET, IPPROTO_TCP, bc, sizeof(bc)), 32);
+	
+	/* Hostcond after the ports */
+	ASSERT_EQ(op[4].code, INET_DIAG_BC_S_COND);
+	ASSERT_EQ(op[4].yes, 16);
+	ASSERT_EQ(op[4].no, 20);
+	
+	/* Prefix too long, buffer too small */
+	filter.src_len = 33;
+	ASSERT_EQ(nlmon_diag_compile_filters(&filter, 1, AF_INET, IPPROTO_TCP, bc, sizeof(bc)), -EINVAL);
+	filter.src_len = 8;
+	ASSERT_EQ(nlmon_diag_compile_filters(&filter, 1, AF_INET, IPPROTO_TCP, bc, 20), -ENOSPC);
+	
+	/* An empty filter needs no bytecode */
+	memset(&filter, 0, sizeof(filter));
+	ASSERT_EQ(nlmon_diag_compile_filters(&filter, 1, AF_INET6, IPPROTO_TCP, bc, sizeof(bc)), 0);
+}
+
+TEST(diag_compile_filters_or)
+{
+	struct nlmon_diag_filter filters[2] = {
+		{ .protocol = IPPROTO_TCP, .sport_min = 22, .sport_max = 22 },
+		{ .protocol = IPPROTO_TCP, .dport_min = 443 },
+	};
+	uint8_t bc[256];
+	struct inet_diag_bc_op *op = (struct inet_diag_bc_op *)bc;
+	
+	/* 16 bytes of the first filter, a jump, 8 bytes of the second */
+	ASSERT_EQ(nlmon_diag_compile_filters(filters, 2, AF_INET, IPPROTO_TCP, bc, sizeof(bc)), 28);
+	
+	/* Failing the first filter tries the second */
+	ASSERT_EQ(op[0].no, 20);
+	ASSERT_EQ(op[2].no, 12);
+	
+	/* Passing it accepts */
+	ASSERT_EQ(op[4].code, INET_DIAG_BC_JMP);
+	ASSERT_EQ(op[4].yes, 4);
+	ASSERT_EQ(op[4].no, 12);
+	
+	ASSERT_EQ(op[5].code, INET_DIAG_BC_D_GE);
+	ASSERT_EQ(op[5].no, 12);
+	ASSERT_EQ(op[6].no, 443);
+}
+
+TEST(diag_dump_incremental)
+{
+	struct nlmon_diag_filter filters[2] = {
+		{ .family = AF_INET, .protocol = IPPROTO_TCP, .src = "127.0.0.0", .src_len = 8 },
+		{ .protocol = IPPROTO_TCP, .sport_min = 1, .sport_max = 1 },
+	};
+	struct nlmon_diag_dump_config config = { .filters = filters, .filter_count = 2 };
+	struct sockaddr_in sin = { .sin_family = AF_INET };
+	struct nlmon_diag_dump_stats stats;
+	struct nlmon_diag_dump *dump;
+	struct changes c;
+	uint16_t port;
+	int lfd, cfd, afd;
+	int ret;
+	
+	lfd = listen_loopback(&port);
+	ASSERT_TRUE(lfd >= 0);
+	filters[0].sport_min = port;
+	filters[0].sport_max = port;
+	
+	dump = nlmon_diag_dump_create(&config);
+	ASSERT_NOT_NULL(dump);
+	ASSERT_TRUE(nlmon_diag_dump_due(dump, 0));
+	
+	memset(&c, 0, sizeof(c));
+	ret = nlmon_diag_dump_run(dump, collect, &c);
+	if (ret < 0) {
+		printf("    NETLINK_SOCK_DIAG unavailable (%d), skipping\n", ret);
+		nlmon_diag_dump_destroy(dump);
+		close(lfd);
+		return;
+	}
+	
+	/* Only the listener matches */
+	ASSERT_EQ(ret, 1);
+	ASSERT_EQ(c.count[NLMON_DIAG_CHANGE_NEW], 1);
+	ASSERT_EQ(c.last_port, port);
+	ASSERT_EQ(c.last_state, TCP_LISTEN);
+	
+	/* Nothing changed */
+	memset(&c, 0, sizeof(c));
+	ASSERT_EQ(nlmon_diag_dump_run(dump, collect, &c), 0);
+	nlmon_diag_dump_get_stats(dump, &stats);
+	ASSERT_EQ(stats.interval, NLMON_DIAG_DUMP_DEFAULT_MIN_INTERVAL * 2);
+	ASSERT_EQ(stats.sockets, 1);
+	
+	/* The accepted end of a connection is new, then changes as the client closes */
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin.sin_port = htons(port);
+	cfd = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_EQ(connect(cfd, (struct sockaddr *)&sin, sizeof(sin)), 0);
+	afd = accept(lfd, NULL, NULL);
+	ASSERT_TRUE(afd >= 0);
+	
+	memset(&c, 0, sizeof(c));
+	ASSERT_EQ(nlmon_diag_dump_run(dump, collect, &c), 1);
+	ASSERT_EQ(c.count[NLMON_DIAG_CHANGE_NEW], 1);
+	ASSERT_EQ(c.last_state, TCP_ESTABLISHED);
+	
+	close(cfd);
+	usleep(50000);
+	memset(&c, 0, sizeof(c));
+	ASSERT_EQ(nlmon_diag_dump_run(dump, collect, &c), 1);
+	ASSERT_EQ(c.count[NLMON_DIAG_CHANGE_CHANGED], 1);
+	ASSERT_EQ(c.last_state, TCP_CLOSE_WAIT);
+	
+	/* Closed sockets are reported gone */
+	close(afd);
+	close(lfd);
+	usleep(50000);
+	memset(&c, 0, sizeof(c));
+	ASSERT_EQ(nlmon_diag_dump_run(dump, collect, &c), 2);
+	ASSERT_EQ(c.count[NLMON_DIAG_CHANGE_GONE], 2);
+	
+	nlmon_diag_dump_get_stats(dump, &stats);
+	ASSERT_EQ(stats.dumps, 5);
+	ASSERT_EQ(stats.sockets_new, 2);
+	ASSERT_EQ(stats.sockets_changed, 1);
+	ASSERT_EQ(stats.sockets_gone, 2);
+	ASSERT_EQ(stats.sockets, 0);
+	ASSERT_EQ(stats.interval, NLMON_DIAG_DUMP_DEFAULT_MIN_INTERVAL);
+	
+	nlmon_diag_dump_destroy(dump);
+}
+
+TEST(diag_dump_silent_baseline)
+{
+	struct nlmon_diag_filter filter = { .family = AF_INET, .protocol = IPPROTO_TCP };
+	struct nlmon_diag_dump_config config = {
+		.filters = &filter,
+		.filter_count = 1,
+		.silent_baseline = true,
+	};
+	struct nlmon_diag_dump *dump;
+	struct changes c;
+	uint16_t port;
+	int lfd, ret;
+	
+	lfd = listen_loopback(&port);
+	ASSERT_TRUE(lfd >= 0);
+	filter.sport_min = port;
+	filter.sport_max = port;
+	
+	dump = nlmon_diag_dump_create(&config);
+	memset(&c, 0, sizeof(c));
+	ret = nlmon_diag_dump_run(dump, collect, &c);
+	if (ret >= 0) {
+		ASSERT_EQ(ret, 0);
+		close(lfd);
+		usleep(50000);
+		ASSERT_EQ(nlmon_diag_dump_run(dump, collect, &c), 1);
+		ASSERT_EQ(c.count[NLMON_DIAG_CHANGE_GONE], 1);
+	} else {
+		close(lfd);
+	}
+	
+	nlmon_diag_dump_destroy(dump);
+	
+	/* Filters that disagree on the family are refused */
+	strcpy(filter.src, "::1");
+	filter.src_len = 128;
+	ASSERT_NULL(nlmon_diag_dump_create(&config));
+}
+
+TEST_SUITE_BEGIN("Netlink Diag Dump")
+	RUN_TEST(diag_compile_single_filter);
+	RUN_TEST(diag_compile_filters_or);
+	RUN_TEST(diag_dump_incremental);
+	RUN_TEST(diag_dump_silent_baseline);
+TEST_SUITE_END()
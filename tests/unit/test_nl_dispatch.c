@@ -0,0 +1,141 @@
+/* test_nl_dispatch.c - Unit tests for the message type dispatch tables */
+
+#include "test_framework.h"
+#include "nlmon_nl_dispatch.h"
+#include "nlmon_nl_event.h"
+#include "nlmon_nl_netfilter.h"
+#include "nlmon_nl_diag.h"
+#include "nlmon_netlink.h"
+#include <string.h>
+#include <linux/rtnetlink.h>
+#include <linux/genetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+
+TEST(route_messages)
+{
+	const struct nlmon_nl_msg_desc *desc;
+
+	desc = nlmon_nl_msg_lookup(NETLINK_ROUTE, RTM_NEWLINK);
+	ASSERT_NOT_NULL(desc);
+	ASSERT_STR_EQ(desc->name, "RTM_NEWLINK");
+	ASSERT_EQ(desc->msg_class, MSG_CLASS_LINK);
+	ASSERT_EQ(desc->hdrlen, sizeof(struct ifinfomsg));
+	ASSERT_EQ(desc->payload_size, sizeof(struct nlmon_link_info));
+	ASSERT_TRUE(desc->parse == nlmon_parse_link_msg);
+	ASSERT_TRUE(desc->decoder == &nlmon_nl_link_decoder);
+	ASSERT_TRUE(desc->cache_update == nlmon_nl_cache_update_link);
+	ASSERT_TRUE(desc->subscribers & NLMON_NL_SUB_STATE);
+
+	/* Neighbors are forwarded but neither cached nor kept for resync */
+	desc = nlmon_nl_msg_lookup(NETLINK_ROUTE, RTM_DELNEIGH);
+	ASSERT_NOT_NULL(desc);
+	ASSERT_EQ(desc->msg_class, MSG_CLASS_NEIGH);
+	ASSERT_EQ(desc->subscribers, NLMON_NL_SUB_EVENTS);
+	ASSERT_NULL(desc->cache_update);
+
+	/* Dump requests parse but are not forwarded */
+	desc = nlmon_nl_msg_lookup(NETLINK_ROUTE, RTM_GETROUTE);
+	ASSERT_NOT_NULL(desc);
+	ASSERT_EQ(desc->msg_class, MSG_CLASS_ROUTE);
+	ASSERT_FALSE(desc->subscribers & NLMON_NL_SUB_EVENTS);
+
+	/* Control messages, holes and the end of the table */
+	ASSERT_NULL(nlmon_nl_msg_lookup(NETLINK_ROUTE, NLMSG_DONE));
+	ASSERT_NULL(nlmon_nl_msg_lookup(NETLINK_ROUTE, RTM_NEWNEIGH - 1));
+	ASSERT_NULL(nlmon_nl_msg_lookup(NETLINK_ROUTE, RTM_NEWRULE));
+	ASSERT_NULL(nlmon_nl_msg_lookup(NETLINK_ROUTE, UINT16_MAX));
+	ASSERT_NULL(nlmon_nl_msg_lookup(NETLINK_AUDIT, RTM_NEWLINK));
+
+	/* Classifier and decoders read the same table */
+	ASSERT_EQ(nlmon_classify_route_msg(RTM_GETADDR), MSG_CLASS_ADDR);
+	ASSERT_EQ(nlmon_classify_route_msg(RTM_NEWRULE), MSG_CLASS_OTHER);
+	ASSERT_TRUE(nlmon_nl_decoder_lookup(NETLINK_ROUTE, RTM_NEWROUTE) == &nlmon_nl_route_decoder);
+	ASSERT_NULL(nlmon_nl_decoder_lookup(NETLINK_ROUTE, RTM_NEWRULE));
+}
+
+TEST(netfilter_and_diag_messages)
+{
+	const struct nlmon_nl_msg_desc *desc;
+
+	desc = nlmon_nl_msg_lookup(NETLINK_NETFILTER,
+	                           (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_DELETE);
+	ASSERT_NOT_NULL(desc);
+	ASSERT_TRUE(desc->parse == nlmon_parse_conntrack_msg);
+	ASSERT_TRUE(desc->decoder == &nlmon_nl_ct_decoder);
+	ASSERT_TRUE(nlmon_nl_decoder_lookup(NETLINK_NETFILTER,
+	                                    (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_NEW) ==
+	            &nlmon_nl_ct_decoder);
+
+	/* Other subsystems and messages are not routed */
+	ASSERT_NULL(nlmon_nl_msg_lookup(NETLINK_NETFILTER,
+	                                (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_GET_CTRZERO));
+	ASSERT_NULL(nlmon_nl_msg_lookup(NETLINK_NETFILTER, NFNL_SUBSYS_QUEUE << 8));
+	ASSERT_NULL(nlmon_nl_msg_lookup(NETLINK_NETFILTER, UINT16_MAX));
+
+	desc = nlmon_nl_msg_lookup(NETLINK_SOCK_DIAG, SOCK_DIAG_BY_FAMILY);
+	ASSERT_NOT_NULL(desc);
+	ASSERT_TRUE(desc->parse == nlmon_parse_inet_diag_msg);
+	ASSERT_NULL(nlmon_nl_msg_lookup(NETLINK_SOCK_DIAG, SOCK_DESTROY));
+}
+
+TEST(genl_families_bind_by_name)
+{
+	const struct nlmon_nl_msg_desc *desc;
+
+	/* The controller is always known */
+	desc = nlmon_nl_msg_lookup(NETLINK_GENERIC, GENL_ID_CTRL);
+	ASSERT_NOT_NULL(desc);
+	ASSERT_TRUE(desc->subscribers & NLMON_NL_SUB_FAMILY);
+
+	/* Other IDs only once bound */
+	ASSERT_NULL(nlmon_nl_msg_lookup(NETLINK_GENERIC, 40));
+	desc = nlmon_nl_msg_bind_genl(40, "nl80211");
+	ASSERT_NOT_NULL(desc);
+	ASSERT_STR_EQ(desc->name, "nl80211");
+	ASSERT_NOT_NULL(desc->parse);
+	ASSERT_TRUE(nlmon_nl_msg_lookup(NETLINK_GENERIC, 40) == desc);
+
+	/* Families without an entry are forwarded with their header only */
+	desc = nlmon_nl_msg_bind_genl(41, "devlink");
+	ASSERT_NOT_NULL(desc);
+	ASSERT_NULL(desc->parse);
+	ASSERT_TRUE(desc->subscribers & NLMON_NL_SUB_EVENTS);
+	ASSERT_TRUE(nlmon_nl_msg_lookup(NETLINK_GENERIC, 41) == desc);
+
+	ASSERT_NULL(nlmon_nl_msg_bind_genl(GENL_MAX_ID + 1, "nl80211"));
+
+	/* Unbound, IDs have to be seen again, the controller stays */
+	nlmon_nl_msg_unbind_genl();
+	ASSERT_NULL(nlmon_nl_msg_lookup(NETLINK_GENERIC, 40));
+	ASSERT_NULL(nlmon_nl_msg_lookup(NETLINK_GENERIC, 41));
+	ASSERT_NOT_NULL(nlmon_nl_msg_lookup(NETLINK_GENERIC, GENL_ID_CTRL));
+}
+
+TEST(payload_sizes)
+{
+	struct nlmon_event evt;
+	char data[8];
+
+	memset(&evt, 0, sizeof(evt));
+	evt.netlink.protocol = NETLINK_ROUTE;
+	evt.netlink.msg_type = RTM_NEWADDR;
+	ASSERT_EQ(nlmon_nl_event_payload_size(&evt), 0);
+
+	evt.netlink.data.generic = data;
+	ASSERT_EQ(nlmon_nl_event_payload_size(&evt), sizeof(struct nlmon_addr_info));
+	evt.netlink.msg_type = RTM_NEWRULE;
+	ASSERT_EQ(nlmon_nl_event_payload_size(&evt), 0);
+
+	evt.netlink.protocol = NETLINK_NETFILTER;
+	evt.netlink.msg_type = (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_NEW;
+	ASSERT_EQ(nlmon_nl_event_payload_size(&evt), sizeof(struct nlmon_ct_info));
+}
+
+TEST_SUITE_BEGIN("Netlink Dispatch")
+	RUN_TEST(route_messages);
+	RUN_TEST(netfilter_and_diag_messages);
+	RUN_TEST(genl_families_bind_by_name);
+	RUN_TEST(payload_sizes);
+TEST_SUITE_END()
@@ -0,0 +1,149 @@
+/* test_nl_family.c - Unit tests for the generic netlink family cache */
+
+#include "test_framework.h"
+#include "nlmon_nl_family.h"
+#include <errno.h>
+#include <string.h>
+#include <netlink/netlink.h>
+#include <netlink/msg.h>
+#include <netlink/attr.h>
+#include <netlink/genl/genl.h>
+
+struct test_group {
+	uint32_t id;
+	const char *name;
+};
+
+/* Build and apply a controller message */
+static int apply_ctrl(uint8_t cmd, uint16_t id, const char *name, uint32_t version,
+                      const struct test_group *groups, int ngroups)
+{
+	struct nl_msg *msg = nlmsg_alloc();
+	int ret;
+	
+	genlmsg_put(msg, 0, 0, GENL_ID_CTRL, 0, 0, cmd, 2);
+	nla_put_u16(msg, CTRL_ATTR_FAMILY_ID, id);
+	if (name)
+		nla_put_string(msg, CTRL_ATTR_FAMILY_NAME, name);
+	if (version)
+		nla_put_u32(msg, CTRL_ATTR_VERSION, version);
+	if (ngroups > 0) {
+		struct nlattr *list = nla_nest_start(msg, CTRL_ATTR_MCAST_GROUPS);
+		
+		for (int i = 0; i < ngroups; i++) {
+			struct nlattr *grp = nla_nest_start(msg, i + 1);
+			
+			nla_put_u32(msg, CTRL_ATTR_MCAST_GRP_ID, groups[i].id);
+			nla_put_string(msg, CTRL_ATTR_MCAST_GRP_NAME, groups[i].name);
+			nla_nest_end(msg, grp);
+		}
+		nla_nest_end(msg, list);
+	}
+	
+	ret = nlmon_genl_family_cache_update(nlmsg_hdr(msg));
+	nlmsg_free(msg);
+	return ret;
+}
+
+TEST(family_new_and_lookup)
+{
+	static const struct test_group groups[] = {
+		{ 20, "config" }, { 21, "scan" }, { 22, "mlme" },
+	};
+	struct nlmon_genl_family family;
+	char name[32];
+	
+	nlmon_genl_family_cache_clear();
+	ASSERT_EQ(apply_ctrl(CTRL_CMD_NEWFAMILY, 30, "nl80211", 1, groups, 3), 1);
+	
+	ASSERT_EQ(nlmon_genl_family_name(30, name, sizeof(name)), 0);
+	ASSERT_STR_EQ(name, "nl80211");
+	ASSERT_EQ(nlmon_genl_family_name(31, name, sizeof(name)), -ENOENT);
+	
+	ASSERT_EQ(nlmon_genl_family_lookup(30, &family), 0);
+	ASSERT_EQ(family.version, 1);
+	ASSERT_EQ(family.ngroups, 3);
+	ASSERT_EQ(nlmon_genl_family_find("nl80211", NULL), 30);
+	ASSERT_EQ(nlmon_genl_family_find("taskstats", NULL), -ENOENT);
+	ASSERT_EQ(nlmon_genl_family_group("nl80211", "scan"), 21);
+	ASSERT_EQ(nlmon_genl_family_group("nl80211", "vendor"), -ENOENT);
+	
+	/* A new registration under the same ID replaces the entry */
+	ASSERT_EQ(apply_ctrl(CTRL_CMD_NEWFAMILY, 30, "devlink", 2, NULL, 0), 1);
+	ASSERT_EQ(nlmon_genl_family_find("nl80211", NULL), -ENOENT);
+	ASSERT_EQ(nlmon_genl_family_find("devlink", &family), 30);
+	ASSERT_EQ(family.ngroups, 0);
+}
+
+TEST(family_colliding_ids)
+{
+	char name[32];
+	
+	/* 16, 144 and 272 share a home slot, 17 sits behind them */
+	nlmon_genl_family_cache_clear();
+	ASSERT_EQ(apply_ctrl(CTRL_CMD_NEWFAMILY, 16, "nlctrl", 2, NULL, 0), 1);
+	ASSERT_EQ(apply_ctrl(CTRL_CMD_NEWFAMILY, 144, "second", 1, NULL, 0), 1);
+	ASSERT_EQ(apply_ctrl(CTRL_CMD_NEWFAMILY, 17, "seventeen", 1, NULL, 0), 1);
+	ASSERT_EQ(apply_ctrl(CTRL_CMD_NEWFAMILY, 272, "third", 1, NULL, 0), 1);
+	
+	/* Deleting the head of the run keeps the rest reachable */
+	ASSERT_EQ(apply_ctrl(CTRL_CMD_DELFAMILY, 16, "nlctrl", 0, NULL, 0), 1);
+	ASSERT_EQ(nlmon_genl_family_name(16, name, sizeof(name)), -ENOENT);
+	ASSERT_EQ(nlmon_genl_family_name(144, name, sizeof(name)), 0);
+	ASSERT_STR_EQ(name, "second");
+	ASSERT_EQ(nlmon_genl_family_name(17, name, sizeof(name)), 0);
+	ASSERT_STR_EQ(name, "seventeen");
+	ASSERT_EQ(nlmon_genl_family_name(272, name, sizeof(name)), 0);
+	ASSERT_STR_EQ(name, "third");
+	
+	ASSERT_EQ(apply_ctrl(CTRL_CMD_DELFAMILY, 16, NULL, 0, NULL, 0), 0);
+}
+
+TEST(family_mcast_groups)
+{
+	static const struct test_group initial[] = { { 5, "events" } };
+	static const struct test_group added[] = { { 6, "errors" }, { 5, "events" } };
+	static const struct test_group removed[] = { { 5, "events" } };
+	struct nlmon_genl_family family;
+	
+	nlmon_genl_family_cache_clear();
+	ASSERT_EQ(apply_ctrl(CTRL_CMD_NEWFAMILY, 40, "thermal", 1, initial, 1), 1);
+	
+	/* Known groups are not added twice */
+	ASSERT_EQ(apply_ctrl(CTRL_CMD_NEWMCAST_GRP, 40, "thermal", 0, added, 2), 1);
+	ASSERT_EQ(nlmon_genl_family_lookup(40, &family), 0);
+	ASSERT_EQ(family.ngroups, 2);
+	ASSERT_EQ(nlmon_genl_family_group("thermal", "errors"), 6);
+	
+	ASSERT_EQ(apply_ctrl(CTRL_CMD_DELMCAST_GRP, 40, "thermal", 0, removed, 1), 1);
+	ASSERT_EQ(nlmon_genl_family_group("thermal", "events"), -ENOENT);
+	ASSERT_EQ(nlmon_genl_family_group("thermal", "errors"), 6);
+	
+	/* Groups of an unknown family name it */
+	ASSERT_EQ(apply_ctrl(CTRL_CMD_NEWMCAST_GRP, 41, "acpi", 0, initial, 1), 1);
+	ASSERT_EQ(nlmon_genl_family_group("acpi", "events"), 5);
+}
+
+TEST(family_ignores_other_messages)
+{
+	struct nl_msg *msg = nlmsg_alloc();
+	
+	nlmon_genl_family_cache_clear();
+	genlmsg_put(msg, 0, 0, 30, 0, 0, CTRL_CMD_NEWFAMILY, 1);
+	nla_put_u16(msg, CTRL_ATTR_FAMILY_ID, 50);
+	nla_put_string(msg, CTRL_ATTR_FAMILY_NAME, "spoofed");
+	ASSERT_EQ(nlmon_genl_family_cache_update(nlmsg_hdr(msg)), 0);
+	ASSERT_EQ(nlmon_genl_family_find("spoofed", NULL), -ENOENT);
+	nlmsg_free(msg);
+	
+	/* A new family needs its name */
+	ASSERT_EQ(apply_ctrl(CTRL_CMD_NEWFAMILY, 50, NULL, 1, NULL, 0), -EINVAL);
+	ASSERT_EQ(apply_ctrl(CTRL_CMD_GETFAMILY, 50, "query", 0, NULL, 0), 0);
+}
+
+TEST_SUITE_BEGIN("Generic Netlink Family Cache")
+	RUN_TEST(family_new_and_lookup);
+	RUN_TEST(family_colliding_ids);
+	RUN_TEST(family_mcast_groups);
+	RUN_TEST(family_ignores_other_messages);
+TEST_SUITE_END()
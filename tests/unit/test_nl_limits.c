@@ -0,0 +1,99 @@
+/* test_nl_limits.c - Unit tests for receive buffer autotuning */
+
+#include "test_framework.h"
+#include "nlmon_nl_limits.h"
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* Small enough to double under the default rmem_max */
+#define TEST_RCVBUF 4096
+
+static int test_socket(void)
+{
+	int val = TEST_RCVBUF;
+	int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	
+	if (fd >= 0)
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val));
+	return fd;
+}
+
+/* Past the one second sample interval */
+static void next_sample(void)
+{
+	struct timespec ts = { 1, 100000000 };
+	
+	nanosleep(&ts, NULL);
+}
+
+TEST(autotune_load_is_per_socket)
+{
+	struct nlmon_nl_limits *limits = nlmon_nl_limits_create();
+	struct nlmon_nl_autotune_config config;
+	int busy = test_socket(), quiet = test_socket();
+	
+	ASSERT_NOT_NULL(limits);
+	ASSERT_TRUE(busy >= 0 && quiet >= 0);
+	
+	memset(&config, 0, sizeof(config));
+	config.enabled = true;
+	config.grow_load = 0.5;
+	nlmon_nl_limits_set_autotune(limits, &config);
+	
+	/* First samples only register the sockets */
+	ASSERT_EQ(nlmon_nl_limits_autotune(limits, busy, false), 0);
+	ASSERT_EQ(nlmon_nl_limits_autotune(limits, quiet, false), 0);
+	
+	/* One socket kept its reader busy for the whole interval */
+	nlmon_nl_limits_record_batch(limits, busy, 1000, 65536, 2000000000ULL);
+	next_sample();
+	
+	ASSERT_EQ(nlmon_nl_limits_autotune(limits, quiet, false), 0);
+	ASSERT_TRUE(nlmon_nl_limits_autotune(limits, busy, false) > TEST_RCVBUF);
+	
+	/* Batches without a socket count only towards the totals */
+	nlmon_nl_limits_record_batch(limits, -1, 1000, 65536, 2000000000ULL);
+	next_sample();
+	ASSERT_EQ(nlmon_nl_limits_autotune(limits, quiet, false), 0);
+	ASSERT_EQ(nlmon_nl_limits_autotune(limits, busy, false), 0);
+	
+	nlmon_nl_limits_forget_socket(limits, busy);
+	nlmon_nl_limits_forget_socket(limits, quiet);
+	close(busy);
+	close(quiet);
+	nlmon_nl_limits_destroy(limits);
+}
+
+TEST(autotune_survives_stats_reset)
+{
+	struct nlmon_nl_limits *limits = nlmon_nl_limits_create();
+	struct nlmon_nl_autotune_config config;
+	int fd = test_socket();
+	
+	ASSERT_NOT_NULL(limits);
+	ASSERT_TRUE(fd >= 0);
+	
+	memset(&config, 0, sizeof(config));
+	config.enabled = true;
+	config.grow_load = 0.5;
+	nlmon_nl_limits_set_autotune(limits, &config);
+	
+	/* Light traffic, then the process-wide counters start over */
+	nlmon_nl_limits_record_batch(limits, fd, 10, 640, 1000);
+	ASSERT_EQ(nlmon_nl_limits_autotune(limits, fd, false), 0);
+	nlmon_nl_limits_record_batch(limits, fd, 10, 640, 1000);
+	nlmon_nl_limits_reset_stats(limits);
+	next_sample();
+	ASSERT_EQ(nlmon_nl_limits_autotune(limits, fd, false), 0);
+	
+	nlmon_nl_limits_forget_socket(limits, fd);
+	close(fd);
+	nlmon_nl_limits_destroy(limits);
+}
+
+TEST_SUITE_BEGIN("Netlink Receive Buffer Autotuning")
+	RUN_TEST(autotune_load_is_per_socket);
+	RUN_TEST(autotune_survives_stats_reset);
+TEST_SUITE_END()
@@ -0,0 +1,232 @@
+/* test_nl_msgpool.c - Unit tests for the netlink message buffer pool */
+
+#include "test_framework.h"
+#include "nlmon_nl_msgpool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POOL_THREADS 4
+
+/* 8 buffers per class up to 4KB, 512 byte requests may spill into 1KB and 2KB */
+#define POOL_SIZE 8
+#define SMALL_POOLED (3 * POOL_SIZE)
+
+/* Buffers parked between threads, freed by whoever takes them out */
+#define EXCHANGE_SLOTS 16
+#define EXCHANGE_ROUNDS 20000
+
+struct pool_race {
+	struct nlmon_nl_msgpool *pool;
+	pthread_barrier_t barrier;
+	_Atomic(uint8_t *) exchange[EXCHANGE_SLOTS];
+	_Atomic int corrupt;              /* Buffers another thread wrote into */
+	
+	/* Exhaustion, small buffers each thread got from the pool */
+	uint8_t *taken[POOL_THREADS][SMALL_POOLED];
+	int taken_count[POOL_THREADS];
+};
+
+struct pool_worker {
+	struct pool_race *race;
+	int id;
+};
+
+/* Size first, then a byte of the writer's repeated over the buffer */
+static void stamp(uint8_t *buf, size_t size, uint8_t owner)
+{
+	memcpy(buf, &size, sizeof(size));
+	memset(buf + sizeof(size), owner, size - sizeof(size));
+}
+
+static bool stamp_intact(const uint8_t *buf)
+{
+	size_t size;
+	uint8_t owner;
+	
+	memcpy(&size, buf, sizeof(size));
+	if (size <= sizeof(size) || size > 96 * 1024)
+		return false;
+	owner = buf[sizeof(size)];
+	for (size_t i = sizeof(size); i < size; i++) {
+		if (buf[i] != owner)
+			return false;
+	}
+	return true;
+}
+
+static void *exchange_thread(void *arg)
+{
+	struct pool_worker *w = arg;
+	struct pool_race *race = w->race;
+	unsigned int seed = w->id + 1;
+	
+	for (int i = 0; i < EXCHANGE_ROUNDS; i++) {
+		/* Sizes from every class, and a few past the largest */
+		size_t size = 16 + rand_r(&seed) % (80 * 1024);
+		uint8_t *buf = nlmon_nl_msgpool_alloc(race->pool, size), *old;
+	
+		if (!buf) {
+			atomic_fetch_add(&race->corrupt, 1);
+			continue;
+		}
+		stamp(buf, size, (uint8_t)(w->id * 64 + i % 64));
+	
+		old = atomic_exchange(&race->exchange[rand_r(&seed) % EXCHANGE_SLOTS], buf);
+		if (old) {
+			if (!stamp_intact(old))
+				atomic_fetch_add(&race->corrupt, 1);
+			nlmon_nl_msgpool_free(race->pool, old);
+		}
+	}
+	return NULL;
+}
+
+TEST(msgpool_threads_recycle_buffers)
+{
+	struct pool_race race = { 0 };
+	struct pool_worker workers[POOL_THREADS];
+	struct nlmon_msgpool_stats stats;
+	pthread_t threads[POOL_THREADS];
+	uint8_t *buf;
+	
+	race.pool = nlmon_nl_msgpool_create(POOL_SIZE, 4096);
+	ASSERT_NOT_NULL(race.pool);
+	
+	for (int i = 0; i < POOL_THREADS; i++) {
+		workers[i].race = &race;
+		workers[i].id = i;
+		pthread_create(&threads[i], NULL, exchange_thread, &workers[i]);
+	}
+	for (int i = 0; i < POOL_THREADS; i++)
+		pthread_join(threads[i], NULL);
+	
+	for (int i = 0; i < EXCHANGE_SLOTS; i++) {
+		buf = atomic_exchange(&race.exchange[i], NULL);
+		if (buf) {
+			if (!stamp_intact(buf))
+				atomic_fetch_add(&race.corrupt, 1);
+			nlmon_nl_msgpool_free(race.pool, buf);
+		}
+	}
+	ASSERT_EQ(atomic_load(&race.corrupt), 0);
+	
+	/* The pool ran dry at times, and every buffer came back */
+	nlmon_nl_msgpool_get_stats(race.pool, &stats);
+	ASSERT_EQ(stats.alloc_requests, POOL_THREADS * EXCHANGE_ROUNDS);
+	ASSERT_TRUE(stats.pool_hits > 0);
+	ASSERT_TRUE(stats.pool_misses > 0);
+	ASSERT_EQ(stats.allocated_count, 0);
+	ASSERT_EQ(stats.free_count, stats.pool_size);
+	
+	nlmon_nl_msgpool_destroy(race.pool);
+}
+
+static void *exhaust_thread(void *arg)
+{
+	struct pool_worker *w = arg;
+	struct pool_race *race = w->race;
+	uint8_t *buf;
+	
+	/* Everyone takes small buffers until the heap serves one */
+	pthread_barrier_wait(&race->barrier);
+	for (;;) {
+		buf = nlmon_nl_msgpool_alloc(race->pool, 512);
+		if (!buf || !nlmon_nl_msgpool_is_pooled(race->pool, buf)) {
+			nlmon_nl_msgpool_free(race->pool, buf);
+			break;
+		}
+		if (race->taken_count[w->id] == SMALL_POOLED) {
+			atomic_fetch_add(&race->corrupt, 1);
+			break;
+		}
+		race->taken[w->id][race->taken_count[w->id]++] = buf;
+	}
+	
+	/* Then frees what the next two took, so two threads free each buffer */
+	pthread_barrier_wait(&race->barrier);
+	for (int next = 1; next <= 2; next++) {
+		int owner = (w->id + next) % POOL_THREADS;
+	
+		for (int i = 0; i < race->taken_count[owner]; i++)
+			nlmon_nl_msgpool_free(race->pool, race->taken[owner][i]);
+	}
+	return NULL;
+}
+
+/* Takes every small buffer, returns how many distinct ones there were */
+static int take_all_small(struct nlmon_nl_msgpool *pool, uint8_t **bufs)
+{
+	int count = 0;
+	uint8_t *buf;
+	
+	while ((buf = nlmon_nl_msgpool_alloc(pool, 512)) != NULL &&
+	       nlmon_nl_msgpool_is_pooled(pool, buf) && count < 2 * SMALL_POOLED) {
+		for (int i = 0; i < count; i++) {
+			if (bufs[i] == buf)
+				return -1;
+		}
+		bufs[count++] = buf;
+	}
+	nlmon_nl_msgpool_free(pool, buf);
+	return count;
+}
+
+TEST(msgpool_threads_exhaust_pool)
+{
+	struct pool_race race = { 0 };
+	struct pool_worker workers[POOL_THREADS];
+	struct nlmon_msgpool_class_stats classes[NLMON_MSGPOOL_CLASSES];
+	struct nlmon_msgpool_stats stats;
+	pthread_t threads[POOL_THREADS];
+	uint8_t *bufs[2 * SMALL_POOLED];
+	int total = 0, count;
+	
+	race.pool = nlmon_nl_msgpool_create(POOL_SIZE, 4096);
+	ASSERT_NOT_NULL(race.pool);
+	pthread_barrier_init(&race.barrier, NULL, POOL_THREADS);
+	
+	for (int i = 0; i < POOL_THREADS; i++) {
+		workers[i].race = &race;
+		workers[i].id = i;
+		pthread_create(&threads[i], NULL, exhaust_thread, &workers[i]);
+	}
+	for (int i = 0; i < POOL_THREADS; i++)
+		pthread_join(threads[i], NULL);
+	pthread_barrier_destroy(&race.barrier);
+	ASSERT_EQ(atomic_load(&race.corrupt), 0);
+	
+	/* Between them the threads got each small buffer exactly once */
+	for (int t = 0; t < POOL_THREADS; t++) {
+		for (int i = 0; i < race.taken_count[t]; i++) {
+			for (int j = 0; j < total; j++)
+				ASSERT_TRUE(bufs[j] != race.taken[t][i]);
+			bufs[total++] = race.taken[t][i];
+		}
+	}
+	ASSERT_EQ(total, SMALL_POOLED);
+	
+	/* Each thread ran out once, and double frees were ignored */
+	ASSERT_EQ(nlmon_nl_msgpool_get_class_stats(race.pool, classes, NLMON_MSGPOOL_CLASSES),
+	          NLMON_MSGPOOL_CLASSES);
+	ASSERT_EQ(classes[0].misses, POOL_THREADS);
+	nlmon_nl_msgpool_get_stats(race.pool, &stats);
+	ASSERT_EQ(stats.allocated_count, 0);
+	
+	/* With the threads gone every buffer can be taken once more */
+	count = take_all_small(race.pool, bufs);
+	ASSERT_EQ(count, SMALL_POOLED);
+	for (int i = 0; i < count; i++)
+		nlmon_nl_msgpool_free(race.pool, bufs[i]);
+	nlmon_nl_msgpool_get_stats(race.pool, &stats);
+	ASSERT_EQ(stats.free_count, stats.pool_size);
+	
+	nlmon_nl_msgpool_destroy(race.pool);
+}
+
+TEST_SUITE_BEGIN("Netlink Message Pool")
+	RUN_TEST(msgpool_threads_recycle_buffers);
+	RUN_TEST(msgpool_threads_exhaust_pool);
+TEST_SUITE_END()
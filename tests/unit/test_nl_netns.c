@@ -0,0 +1,216 @@
+/* test_nl_netns.c - Unit tests for netlink monitoring across namespaces */
+
+#define _GNU_SOURCE
+#include "test_framework.h"
+#include "nlmon_nl_netns.h"
+#include "nlmon_netlink.h"
+#include "event_processor.h"
+#include "namespace_tracker.h"
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <linux/rtnetlink.h>
+
+struct seen {
+	unsigned long events;
+	unsigned long links;
+	uint64_t last_netns;
+};
+
+static void record_event(struct nlmon_event *evt, void *user_data)
+{
+	struct seen *seen = user_data;
+	
+	seen->events++;
+	if (evt->netlink.msg_type == RTM_NEWLINK)
+		seen->links++;
+	seen->last_netns = evt->netlink.netns;
+}
+
+static int setup_calls;
+
+static int count_setup(struct nlmon_nl_manager *mgr, void *user_data)
+{
+	setup_calls++;
+	return 0;
+}
+
+/* Child in a namespace of its own, brings up its loopback on request */
+struct netns_child {
+	pid_t pid;
+	int to_child;
+	int from_child;
+	char path[64];
+	uint64_t ino;
+};
+
+static int child_start(struct netns_child *child)
+{
+	int down[2], up[2];
+	struct stat st;
+	char ok;
+	
+	if (pipe(down) < 0 || pipe(up) < 0)
+		return -1;
+	
+	child->pid = fork();
+	if (child->pid == 0) {
+		struct ifreq ifr;
+		int fd;
+		
+		ok = unshare(CLONE_NEWNET) == 0;
+		if (write(up[1], &ok, 1) != 1 || !ok)
+			_exit(1);
+		if (read(down[0], &ok, 1) != 1)
+			_exit(1);
+		
+		fd = socket(AF_INET, SOCK_DGRAM, 0);
+		memset(&ifr, 0, sizeof(ifr));
+		snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "lo");
+		ioctl(fd, SIOCGIFFLAGS, &ifr);
+		ifr.ifr_flags |= IFF_UP;
+		ioctl(fd, SIOCSIFFLAGS, &ifr);
+		for (;;)
+			pause();
+	}
+	
+	close(down[0]);
+	close(up[1]);
+	child->to_child = down[1];
+	child->from_child = up[0];
+	if (read(child->from_child, &ok, 1) != 1 || !ok) {
+		waitpid(child->pid, NULL, 0);
+		return -1;
+	}
+	
+	snprintf(child->path, sizeof(child->path), "/proc/%d/ns/net", (int)child->pid);
+	if (stat(child->path, &st) < 0)
+		return -1;
+	child->ino = st.st_ino;
+	return 0;
+}
+
+static void child_stop(struct netns_child *child)
+{
+	kill(child->pid, SIGKILL);
+	waitpid(child->pid, NULL, 0);
+	close(child->to_child);
+	close(child->from_child);
+}
+
+TEST(netns_events_tagged)
+{
+	struct nlmon_nl_netns_config config = {0};
+	struct nlmon_nl_netns_stats stats;
+	struct nlmon_nl_netns_set *set;
+	struct netns_child child;
+	struct seen seen = {0};
+	char name[32];
+	
+	if (child_start(&child) < 0) {
+		printf("  (skipped, cannot create a network namespace)\n");
+		return;
+	}
+	
+	config.enable_route = 1;
+	config.event_callback = record_event;
+	config.user_data = &seen;
+	config.setup = count_setup;
+	set = nlmon_nl_netns_create(&config);
+	ASSERT_NOT_NULL(set);
+	ASSERT_TRUE(nlmon_nl_netns_get_fd(set) >= 0);
+	
+	ASSERT_EQ(nlmon_nl_netns_attach(set, child.path, "child"), 0);
+	ASSERT_EQ(nlmon_nl_netns_attach(set, child.path, "child"), 0);
+	ASSERT_EQ(setup_calls, 1);
+	ASSERT_EQ(nlmon_nl_netns_name(set, child.ino, name, sizeof(name)), 0);
+	ASSERT_STR_EQ(name, "child");
+	
+	/* The child's link change reaches us, tagged with its namespace */
+	ASSERT_EQ(write(child.to_child, "g", 1), 1);
+	for (int wait = 0; wait < 50 && seen.links == 0; wait++)
+		nlmon_nl_netns_process(set, 100);
+	ASSERT_TRUE(seen.links > 0);
+	ASSERT_EQ(seen.last_netns, child.ino);
+	
+	nlmon_nl_netns_get_stats(set, &stats);
+	ASSERT_EQ(stats.namespaces, 1);
+	ASSERT_EQ(stats.events, seen.events);
+	
+	ASSERT_EQ(nlmon_nl_netns_detach(set, child.ino), 0);
+	ASSERT_EQ(nlmon_nl_netns_detach(set, child.ino), -ENOENT);
+	ASSERT_EQ(nlmon_nl_netns_name(set, child.ino, name, sizeof(name)), -ENOENT);
+	
+	nlmon_nl_netns_destroy(set);
+	child_stop(&child);
+}
+
+TEST(netns_sync_follows_tracker)
+{
+	struct nlmon_nl_netns_config config = {0};
+	struct nlmon_nl_netns_stats stats;
+	struct nlmon_nl_netns_set *set;
+	struct namespace_tracker *tracker;
+	struct netns_child child;
+	char name[32];
+	
+	if (child_start(&child) < 0) {
+		printf("  (skipped, cannot create a network namespace)\n");
+		return;
+	}
+	
+	tracker = namespace_tracker_init();
+	ASSERT_NOT_NULL(tracker);
+	config.enable_route = 1;
+	set = nlmon_nl_netns_create(&config);
+	ASSERT_NOT_NULL(set);
+	
+	/* Our own namespace is left to the caller's manager */
+	namespace_tracker_update_cache(tracker);
+	ASSERT_TRUE(nlmon_nl_netns_sync(set, tracker) >= 1);
+	ASSERT_EQ(nlmon_nl_netns_name(set, child.ino, name, sizeof(name)), 0);
+	nlmon_nl_netns_get_stats(set, &stats);
+	ASSERT_EQ(stats.attached, stats.namespaces);
+	
+	/* Detached once the last process in it is gone */
+	child_stop(&child);
+	namespace_tracker_update_cache(tracker);
+	ASSERT_TRUE(nlmon_nl_netns_sync(set, tracker) >= 0);
+	ASSERT_EQ(nlmon_nl_netns_name(set, child.ino, name, sizeof(name)), -ENOENT);
+	nlmon_nl_netns_get_stats(set, &stats);
+	ASSERT_TRUE(stats.detached >= 1);
+	
+	nlmon_nl_netns_destroy(set);
+	namespace_tracker_destroy(tracker);
+}
+
+TEST(netns_invalid)
+{
+	struct nlmon_nl_netns_config config = {0};
+	struct nlmon_nl_netns_set *set;
+	
+	ASSERT_NULL(nlmon_nl_netns_create(NULL));
+	ASSERT_EQ(nlmon_nl_netns_get_fd(NULL), -1);
+	nlmon_nl_netns_destroy(NULL);
+	
+	set = nlmon_nl_netns_create(&config);
+	ASSERT_NOT_NULL(set);
+	ASSERT_EQ(nlmon_nl_netns_attach(set, "/nonexistent/ns", NULL), -ENOENT);
+	ASSERT_EQ(nlmon_nl_netns_detach(set, 1), -ENOENT);
+	ASSERT_EQ(nlmon_nl_netns_process(set, 0), 0);
+	nlmon_nl_netns_destroy(set);
+}
+
+TEST_SUITE_BEGIN("Netlink Namespaces")
+	RUN_TEST(netns_events_tagged);
+	RUN_TEST(netns_sync_follows_tracker);
+	RUN_TEST(netns_invalid);
+TEST_SUITE_END()
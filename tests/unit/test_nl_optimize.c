@@ -0,0 +1,88 @@
+/* test_nl_optimize.c - Unit tests for the optimized message walk */
+
+#include "test_framework.h"
+#include "nlmon_nl_optimize.h"
+#include <errno.h>
+#include <string.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#define MAX_SEEN 8
+
+struct walk {
+	int count;
+	uint32_t seq[MAX_SEEN];
+};
+
+static int record(struct nlmsghdr *nlh, void *arg)
+{
+	struct walk *walk = arg;
+	
+	if (walk->count < MAX_SEEN)
+		walk->seq[walk->count] = nlh->nlmsg_seq;
+	walk->count++;
+	return 0;
+}
+
+/* count messages of 32 bytes each, numbered from 1, then poison */
+static size_t build(void *buf, size_t size, int count)
+{
+	size_t len = 0;
+	
+	memset(buf, 0xff, size);
+	for (int i = 0; i < count; i++) {
+		struct nlmsghdr *nlh = (struct nlmsghdr *)((char *)buf + len);
+	
+		memset(nlh, 0, 32);
+		nlh->nlmsg_len = 32;
+		nlh->nlmsg_type = RTM_NEWLINK;
+		nlh->nlmsg_seq = i + 1;
+		len += 32;
+	}
+	return len;
+}
+
+TEST(walk_every_message)
+{
+	char buf[256] __attribute__((aligned(4)));
+	struct walk walk;
+	
+	for (int count = 1; count <= 3; count++) {
+		size_t len = build(buf, sizeof(buf), count);
+	
+		memset(&walk, 0, sizeof(walk));
+		ASSERT_EQ(nlmon_iterate_messages_optimized(buf, len, record, &walk), count);
+		ASSERT_EQ(walk.count, count);
+		for (int i = 0; i < count; i++)
+			ASSERT_EQ(walk.seq[i], (uint32_t)i + 1);
+	}
+}
+
+TEST(walk_stops_at_datagram_end)
+{
+	char buf[256] __attribute__((aligned(4)));
+	struct nlmsghdr *last;
+	struct walk walk;
+	size_t len;
+	
+	/* An unpadded last message must not wrap the remaining length */
+	len = build(buf, sizeof(buf), 2);
+	last = (struct nlmsghdr *)(buf + 32);
+	last->nlmsg_len = 30;
+	len -= 2;
+	memset(&walk, 0, sizeof(walk));
+	ASSERT_EQ(nlmon_iterate_messages_optimized(buf, len, record, &walk), 2);
+	ASSERT_EQ(walk.count, 2);
+	
+	/* A truncated message is not handled */
+	len = build(buf, sizeof(buf), 3) - 8;
+	memset(&walk, 0, sizeof(walk));
+	ASSERT_EQ(nlmon_iterate_messages_optimized(buf, len, record, &walk), 2);
+	
+	ASSERT_EQ(nlmon_iterate_messages_optimized(buf, 0, record, &walk), -EINVAL);
+}
+
+TEST_SUITE_BEGIN("Netlink Message Walk")
+	RUN_TEST(walk_every_message);
+	RUN_TEST(walk_stops_at_datagram_end);
+TEST_SUITE_END()
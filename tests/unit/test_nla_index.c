@@ -0,0 +1,128 @@
+/* test_nla_index.c - Unit tests for bitmap attribute indexing in the bundled libnl */
+
+#include "test_framework.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <netlink/attr.h>
+
+#define TEST_ATTR_MAX 70
+
+static struct nlattr *put_attr(uint8_t *buf, int *len, uint16_t type,
+                               const void *data, int size)
+{
+	struct nlattr *nla = (struct nlattr *)(buf + *len);
+
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + size;
+	memcpy(buf + *len + NLA_HDRLEN, data, size);
+	*len += NLA_ALIGN(nla->nla_len);
+	return nla;
+}
+
+TEST(nla_index_presence)
+{
+	uint8_t buf[256] __attribute__((aligned(4)));
+	uint32_t v1 = 1, v2 = 2, v65 = 65;
+	NLA_INDEX(TEST_ATTR_MAX) idx;
+	int len = 0;
+
+	put_attr(buf, &len, 1, &v1, sizeof(v1));
+	put_attr(buf, &len, 65, &v65, sizeof(v65));
+	put_attr(buf, &len, 1, &v2, sizeof(v2));
+	put_attr(buf, &len, TEST_ATTR_MAX + 1, &v1, sizeof(v1));
+
+	/* Stale storage must not leak through */
+	memset(&idx, 0xff, sizeof(idx));
+	ASSERT_EQ(nla_parse_index(&idx.hdr, TEST_ATTR_MAX, (struct nlattr *)buf, len,
+	                          NULL, NULL), 0);
+	ASSERT_EQ(idx.hdr.count, 2);
+
+	/* The last duplicate wins, as with nla_parse() */
+	ASSERT_NOT_NULL(nla_index_get(&idx.hdr, 1));
+	ASSERT_EQ(nla_get_u32(nla_index_get(&idx.hdr, 1)), 2);
+	ASSERT_EQ(nla_get_u32(nla_index_get(&idx.hdr, 65)), 65);
+
+	ASSERT_NULL(nla_index_get(&idx.hdr, 0));
+	ASSERT_NULL(nla_index_get(&idx.hdr, 2));
+	ASSERT_NULL(nla_index_get(&idx.hdr, TEST_ATTR_MAX + 1));
+	ASSERT_NULL(nla_index_get(&idx.hdr, -1));
+}
+
+TEST(nla_index_matches_parse)
+{
+	uint8_t buf[256] __attribute__((aligned(4)));
+	struct nlattr *tb[TEST_ATTR_MAX + 1];
+	NLA_INDEX(TEST_ATTR_MAX) idx;
+	uint32_t v = 7;
+	int len = 0, i;
+
+	put_attr(buf, &len, 3, &v, sizeof(v));
+	put_attr(buf, &len, 64, &v, sizeof(v));
+	put_attr(buf, &len, 12, "eth0", 5);
+	put_attr(buf, &len, TEST_ATTR_MAX, &v, sizeof(v));
+
+	ASSERT_EQ(nla_parse(tb, TEST_ATTR_MAX, (struct nlattr *)buf, len, NULL), 0);
+	ASSERT_EQ(nla_parse_index(&idx.hdr, TEST_ATTR_MAX, (struct nlattr *)buf, len,
+	                          NULL, NULL), 0);
+
+	for (i = 0; i <= TEST_ATTR_MAX; i++)
+		ASSERT_TRUE(nla_index_get(&idx.hdr, i) == tb[i]);
+}
+
+TEST(nla_index_policy)
+{
+	uint8_t buf[256] __attribute__((aligned(4)));
+	struct nla_policy policy[TEST_ATTR_MAX + 1];
+	NLA_INDEX(TEST_ATTR_MAX) idx;
+	uint64_t trusted[NLA_INDEX_WORDS(TEST_ATTR_MAX)] = { 0 };
+	uint16_t shortv = 1;
+	int len = 0;
+
+	memset(policy, 0, sizeof(policy));
+	policy[4].type = NLA_U32;
+	policy[66].type = NLA_U32;
+
+	/* A two byte value where a u32 is expected */
+	put_attr(buf, &len, 66, &shortv, sizeof(shortv));
+	ASSERT_TRUE(nla_parse_index(&idx.hdr, TEST_ATTR_MAX, (struct nlattr *)buf, len,
+	                            policy, NULL) < 0);
+
+	/* Types the caller vouches for are not checked again */
+	trusted[66 / 64] = NLA_INDEX_BIT(66);
+	ASSERT_EQ(nla_parse_index(&idx.hdr, TEST_ATTR_MAX, (struct nlattr *)buf, len,
+	                          policy, trusted), 0);
+	ASSERT_NOT_NULL(nla_index_get(&idx.hdr, 66));
+
+	/* Absent types are not checked */
+	len = 0;
+	put_attr(buf, &len, 5, &shortv, sizeof(shortv));
+	ASSERT_EQ(nla_parse_index(&idx.hdr, TEST_ATTR_MAX, (struct nlattr *)buf, len,
+	                          policy, NULL), 0);
+	ASSERT_NULL(nla_index_get(&idx.hdr, 4));
+}
+
+TEST(nla_index_nested)
+{
+	uint8_t buf[256] __attribute__((aligned(4)));
+	NLA_INDEX(8) idx;
+	struct nlattr *outer;
+	uint32_t v = 9;
+	int len = 0, start;
+
+	outer = put_attr(buf, &len, 1 | NLA_F_NESTED, &v, 0);
+	start = len - NLA_HDRLEN;
+	put_attr(buf, &len, 2, &v, sizeof(v));
+	outer->nla_len = len - start;
+
+	ASSERT_EQ(nla_parse_nested_index(&idx.hdr, 8, outer, NULL, NULL), 0);
+	ASSERT_EQ(idx.hdr.count, 1);
+	ASSERT_EQ(nla_get_u32(nla_index_get(&idx.hdr, 2)), 9);
+}
+
+TEST_SUITE_BEGIN("Netlink Attribute Index")
+	RUN_TEST(nla_index_presence);
+	RUN_TEST(nla_index_matches_parse);
+	RUN_TEST(nla_index_policy);
+	RUN_TEST(nla_index_nested);
+TEST_SUITE_END()
@@ -0,0 +1,79 @@
+/* test_nlmon_clock.c - Unit tests for the shared time service */
+
+#include "test_framework.h"
+#include "nlmon_clock.h"
+#include <time.h>
+#include <unistd.h>
+
+#define MS 1000000ULL
+
+static uint64_t distance(uint64_t a, uint64_t b)
+{
+	return a > b ? a - b : b - a;
+}
+
+TEST(clock_without_ticker)
+{
+	ASSERT_FALSE(nlmon_clock_running());
+	
+	/* The kernel's coarse clocks, a few milliseconds behind at most */
+	ASSERT_TRUE(distance(nlmon_clock_realtime_ns(), nlmon_clock_read(CLOCK_REALTIME)) < 50 * MS);
+	ASSERT_TRUE(distance(nlmon_clock_monotonic_ns(), nlmon_clock_precise_ns()) < 50 * MS);
+	ASSERT_TRUE(distance((uint64_t)nlmon_clock_seconds(), (uint64_t)time(NULL)) <= 1);
+}
+
+TEST(clock_ticker_updates_the_page)
+{
+	uint64_t ticks, realtime, monotonic;
+	int waited;
+	
+	ASSERT_EQ(nlmon_clock_start(1), 0);
+	ASSERT_TRUE(nlmon_clock_running());
+	
+	/* Started twice is still one ticker */
+	ASSERT_EQ(nlmon_clock_start(1), 0);
+	
+	ASSERT_TRUE(atomic_load(&nlmon_clock_page.realtime_ns) != 0);
+	ticks = atomic_load(&nlmon_clock_page.ticks);
+	realtime = nlmon_clock_realtime_ns();
+	monotonic = nlmon_clock_monotonic_ns();
+	
+	for (waited = 0; waited < 1000 && atomic_load(&nlmon_clock_page.ticks) < ticks + 5; waited++)
+		usleep(1000);
+	ASSERT_TRUE(atomic_load(&nlmon_clock_page.ticks) >= ticks + 5);
+	
+	/* Readers see the page, which moves forward with the kernel's clocks */
+	ASSERT_TRUE(nlmon_clock_realtime_ns() > realtime);
+	ASSERT_TRUE(nlmon_clock_monotonic_ns() > monotonic);
+	ASSERT_TRUE(nlmon_clock_monotonic_ns() <= nlmon_clock_precise_ns());
+	ASSERT_TRUE(distance(nlmon_clock_realtime_ns(), nlmon_clock_read(CLOCK_REALTIME)) < 50 * MS);
+	
+	/* Stopped, readers go back to the kernel */
+	nlmon_clock_stop();
+	ASSERT_FALSE(nlmon_clock_running());
+	ASSERT_EQ(atomic_load(&nlmon_clock_page.realtime_ns), 0);
+	ASSERT_TRUE(distance(nlmon_clock_realtime_ns(), nlmon_clock_read(CLOCK_REALTIME)) < 50 * MS);
+	nlmon_clock_stop();
+}
+
+TEST(clock_cycles_convert_to_nanoseconds)
+{
+	uint64_t start_ns, start, elapsed_ns, converted;
+	
+	ASSERT_TRUE(nlmon_clock_ns_per_cycle() > 0.0);
+	
+	start_ns = nlmon_clock_precise_ns();
+	start = nlmon_clock_cycles();
+	usleep(20000);
+	converted = nlmon_clock_cycles_to_ns(nlmon_clock_cycles() - start);
+	elapsed_ns = nlmon_clock_precise_ns() - start_ns;
+	
+	/* Within a tenth of the precise clock */
+	ASSERT_TRUE(distance(converted, elapsed_ns) < elapsed_ns / 10);
+}
+
+TEST_SUITE_BEGIN("Clock")
+	RUN_TEST(clock_without_ticker);
+	RUN_TEST(clock_ticker_updates_the_page);
+	RUN_TEST(clock_cycles_convert_to_nanoseconds);
+TEST_SUITE_END()
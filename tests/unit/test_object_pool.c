@@ -3,47 +3,54 @@
 #include "test_framework.h"
 #include "object_pool.h"
 #include <pthread.h>
+#include <stdint.h>
 
 TEST(object_pool_create_destroy)
 {
-	struct object_pool *pool = object_pool_create(10, 64, NULL, NULL);
-	ASSERT_NOT_NULL(pool);
+	struct object_pool *pool = object_pool_create(64, 10);
+	struct object_pool_stats stats;
 	
-	size_t capacity, available, allocated;
-	object_pool_stats(pool, &capacity, &available, &allocated);
+	ASSERT_NOT_NULL(pool);
 	
-	ASSERT_EQ(capacity, 10);
-	ASSERT_EQ(available, 10);
-	ASSERT_EQ(allocated, 0);
+	object_pool_get_stats(pool, &stats);
+	ASSERT_EQ(stats.capacity, 10);
+	ASSERT_EQ(stats.allocated, 0);
+	ASSERT_EQ(object_pool_get_capacity(pool), 10);
 	
 	object_pool_destroy(pool);
+	
+	ASSERT_NULL(object_pool_create(0, 10));
+	ASSERT_NULL(object_pool_create(64, 0));
 }
 
 TEST(object_pool_alloc_free)
 {
-	struct object_pool *pool = object_pool_create(5, 64, NULL, NULL);
+	struct object_pool *pool = object_pool_create(64, 5);
+	struct object_pool_stats stats;
+	
 	ASSERT_NOT_NULL(pool);
 	
 	void *obj = object_pool_alloc(pool);
 	ASSERT_NOT_NULL(obj);
 	
-	size_t capacity, available, allocated;
-	object_pool_stats(pool, &capacity, &available, &allocated);
-	ASSERT_EQ(available, 4);
-	ASSERT_EQ(allocated, 1);
+	object_pool_get_stats(pool, &stats);
+	ASSERT_EQ(stats.allocated, 1);
+	ASSERT_EQ(stats.pool_hits, 1);
 	
 	object_pool_free(pool, obj);
 	
-	object_pool_stats(pool, &capacity, &available, &allocated);
-	ASSERT_EQ(available, 5);
-	ASSERT_EQ(allocated, 0);
+	object_pool_get_stats(pool, &stats);
+	ASSERT_EQ(stats.allocated, 0);
+	ASSERT_EQ(stats.total_frees, 1);
 	
 	object_pool_destroy(pool);
 }
 
 TEST(object_pool_exhaustion)
 {
-	struct object_pool *pool = object_pool_create(3, 64, NULL, NULL);
+	struct object_pool *pool = object_pool_create(64, 3);
+	struct object_pool_stats stats;
+	
 	ASSERT_NOT_NULL(pool);
 	
 	void *objs[3];
@@ -54,66 +61,55 @@ TEST(object_pool_exhaustion)
 		ASSERT_NOT_NULL(objs[i]);
 	}
 	
-	/* Pool should be exhausted */
+	/* Pool is exhausted, further objects come from the heap */
 	void *extra = object_pool_alloc(pool);
-	ASSERT_NULL(extra);
+	ASSERT_NOT_NULL(extra);
+	
+	object_pool_get_stats(pool, &stats);
+	ASSERT_EQ(stats.pool_hits, 3);
+	ASSERT_EQ(stats.pool_misses, 1);
+	ASSERT_EQ(stats.allocated, 4);
+	ASSERT_EQ(stats.peak_usage, 4);
 	
-	/* Free one and try again */
+	/* Free one and try again, the slab serves it */
+	object_pool_free(pool, extra);
 	object_pool_free(pool, objs[0]);
 	extra = object_pool_alloc(pool);
-	ASSERT_NOT_NULL(extra);
+	ASSERT_EQ(extra, objs[0]);
 	
 	/* Cleanup */
 	object_pool_free(pool, extra);
 	object_pool_free(pool, objs[1]);
 	object_pool_free(pool, objs[2]);
 	
+	ASSERT_EQ(object_pool_get_usage(pool), 0);
 	object_pool_destroy(pool);
 }
 
-/* Init/cleanup callbacks for testing */
-static int init_count = 0;
-static int cleanup_count = 0;
-
-static void test_init(void *obj)
-{
-	init_count++;
-	*(int *)obj = 42;
-}
-
-static void test_cleanup(void *obj)
-{
-	cleanup_count++;
-	*(int *)obj = 0;
-}
-
-TEST(object_pool_callbacks)
+TEST(object_pool_zeroes_objects)
 {
-	init_count = 0;
-	cleanup_count = 0;
+	struct object_pool *pool = object_pool_create(sizeof(int) * 4, 2);
 	
-	struct object_pool *pool = object_pool_create(5, sizeof(int),
-	                                              test_init, test_cleanup);
 	ASSERT_NOT_NULL(pool);
 	
-	/* Init should be called for all objects */
-	ASSERT_EQ(init_count, 5);
-	
 	int *obj = (int *)object_pool_alloc(pool);
 	ASSERT_NOT_NULL(obj);
-	ASSERT_EQ(*obj, 42);
-	
+	for (int i = 0; i < 4; i++)
+		obj[i] = 42;
 	object_pool_free(pool, obj);
-	ASSERT_EQ(cleanup_count, 1);
 	
+	obj = (int *)object_pool_alloc(pool);
+	ASSERT_NOT_NULL(obj);
+	for (int i = 0; i < 4; i++)
+		ASSERT_EQ(obj[i], 0);
+	
+	object_pool_free(pool, obj);
 	object_pool_destroy(pool);
-	/* Cleanup should be called for remaining objects */
-	ASSERT_EQ(cleanup_count, 5);
 }
 
 TEST(object_pool_reuse)
 {
-	struct object_pool *pool = object_pool_create(2, sizeof(int), NULL, NULL);
+	struct object_pool *pool = object_pool_create(sizeof(int), 2);
 	ASSERT_NOT_NULL(pool);
 	
 	int *obj1 = (int *)object_pool_alloc(pool);
@@ -153,7 +149,8 @@ static void *pool_worker_thread(void *arg)
 
 TEST(object_pool_concurrent)
 {
-	struct object_pool *pool = object_pool_create(10, sizeof(int), NULL, NULL);
+	struct object_pool *pool = object_pool_create(sizeof(int), 10);
+	struct object_pool_stats stats;
 	ASSERT_NOT_NULL(pool);
 	
 	pthread_t threads[4];
@@ -166,11 +163,211 @@ TEST(object_pool_concurrent)
 		pthread_join(threads[i], NULL);
 	}
 	
-	/* All objects should be back in pool */
-	size_t capacity, available, allocated;
-	object_pool_stats(pool, &capacity, &available, &allocated);
-	ASSERT_EQ(available, 10);
-	ASSERT_EQ(allocated, 0);
+	/* All objects are back, the exited threads' caches folded in */
+	object_pool_get_stats(pool, &stats);
+	ASSERT_EQ(stats.allocated, 0);
+	ASSERT_EQ(stats.total_allocs, 400);
+	ASSERT_EQ(stats.total_frees, 400);
+	ASSERT_EQ(object_pool_get_thread_stats(pool, NULL, 0), 0);
+	
+	object_pool_destroy(pool);
+}
+
+/* Objects allocated on one thread and freed on another */
+#define HANDOFF_BATCH 32
+#define HANDOFF_ROUNDS 2000
+
+struct handoff {
+	struct object_pool *pool;
+	pthread_barrier_t barrier;
+	uint64_t *batch[2][HANDOFF_BATCH];
+	int bad;                  /* Objects not zeroed or handed out twice */
+};
+
+static void *handoff_producer(void *arg)
+{
+	struct handoff *h = arg;
+	
+	for (int round = 0; round < HANDOFF_ROUNDS; round++) {
+		uint64_t **batch = h->batch[round & 1];
+	
+		for (int i = 0; i < HANDOFF_BATCH; i++) {
+			batch[i] = object_pool_alloc(h->pool);
+			if (!batch[i] || batch[i][0] != 0)
+				h->bad++;
+			else
+				batch[i][0] = ((uint64_t)round << 8) | i;
+		}
+		pthread_barrier_wait(&h->barrier);
+	}
+	
+	return NULL;
+}
+
+static void *handoff_consumer(void *arg)
+{
+	struct handoff *h = arg;
+	
+	/* Frees the previous round's batch while the next one is allocated */
+	for (int round = 0; round <= HANDOFF_ROUNDS; round++) {
+		if (round > 0) {
+			uint64_t **batch = h->batch[(round - 1) & 1];
+	
+			for (int i = 0; i < HANDOFF_BATCH; i++) {
+				if (batch[i] && batch[i][0] != (((uint64_t)(round - 1) << 8) | i))
+					h->bad++;
+				object_pool_free(h->pool, batch[i]);
+			}
+		}
+		if (round < HANDOFF_ROUNDS)
+			pthread_barrier_wait(&h->barrier);
+	}
+	
+	return NULL;
+}
+
+TEST(object_pool_cross_thread_free)
+{
+	struct object_pool_options opts = {
+		.object_size = sizeof(uint64_t),
+		.capacity = 256,
+		.magazine_size = 8,
+	};
+	struct object_pool_stats stats;
+	struct handoff h = { 0 };
+	pthread_t producer, consumer;
+	
+	h.pool = object_pool_create_opts(&opts);
+	ASSERT_NOT_NULL(h.pool);
+	pthread_barrier_init(&h.barrier, NULL, 2);
+	
+	pthread_create(&producer, NULL, handoff_producer, &h);
+	pthread_create(&consumer, NULL, handoff_consumer, &h);
+	pthread_join(producer, NULL);
+	pthread_join(consumer, NULL);
+	pthread_barrier_destroy(&h.barrier);
+	
+	ASSERT_EQ(h.bad, 0);
+	
+	/*
+	 * The producer only gets objects back through the depot. Two batches
+	 * and both threads' magazines fit the slab, so it never ran dry.
+	 */
+	object_pool_get_stats(h.pool, &stats);
+	ASSERT_EQ(stats.total_allocs, HANDOFF_ROUNDS * HANDOFF_BATCH);
+	ASSERT_EQ(stats.total_frees, HANDOFF_ROUNDS * HANDOFF_BATCH);
+	ASSERT_EQ(stats.pool_misses, 0);
+	ASSERT_EQ(stats.allocated, 0);
+	ASSERT_TRUE(stats.depot_refills > HANDOFF_ROUNDS);
+	ASSERT_TRUE(stats.depot_flushes > HANDOFF_ROUNDS);
+	ASSERT_EQ(object_pool_get_thread_stats(h.pool, NULL, 0), 0);
+	
+	/* Every object is back in the depot */
+	void *objs[256];
+	
+	for (int i = 0; i < 256; i++)
+		objs[i] = object_pool_alloc(h.pool);
+	object_pool_get_stats(h.pool, &stats);
+	ASSERT_EQ(stats.pool_misses, 0);
+	for (int i = 0; i < 256; i++)
+		object_pool_free(h.pool, objs[i]);
+	
+	object_pool_destroy(h.pool);
+}
+
+/* A thread holding a cache of a pool across its destruction */
+struct stale_cache {
+	struct object_pool *pool;
+	pthread_barrier_t barrier;
+	int bad;
+};
+
+static void *stale_cache_thread(void *arg)
+{
+	struct stale_cache *s = arg;
+	void *objs[4];
+	
+	/* Leave objects of the first pool in this thread's cache */
+	for (int i = 0; i < 4; i++)
+		objs[i] = object_pool_alloc(s->pool);
+	for (int i = 0; i < 4; i++)
+		object_pool_free(s->pool, objs[i]);
+	pthread_barrier_wait(&s->barrier);
+	
+	/* The pool was replaced by another at the same address */
+	pthread_barrier_wait(&s->barrier);
+	for (int i = 0; i < 4; i++) {
+		objs[i] = object_pool_alloc(s->pool);
+		if (!objs[i] || *(int *)objs[i] != 0)
+			s->bad++;
+	}
+	for (int i = 0; i < 4; i++)
+		object_pool_free(s->pool, objs[i]);
+	
+	return NULL;
+}
+
+TEST(object_pool_recreate_at_same_address)
+{
+	struct object_pool_options opts = {
+		.object_size = sizeof(int),
+		.capacity = 16,
+		.magazine_size = 4,
+	};
+	struct object_pool *old, *pool, *others[64];
+	struct object_pool_thread_stats tstats[2];
+	struct object_pool_stats stats;
+	struct stale_cache s = { 0 };
+	int nothers = 0;
+	pthread_t thread;
+	void *obj;
+	
+	old = object_pool_create_opts(&opts);
+	ASSERT_NOT_NULL(old);
+	s.pool = old;
+	pthread_barrier_init(&s.barrier, NULL, 2);
+	pthread_create(&thread, NULL, stale_cache_thread, &s);
+	
+	/* This thread caches objects of the first pool too */
+	obj = object_pool_alloc(old);
+	object_pool_free(old, obj);
+	pthread_barrier_wait(&s.barrier);
+	
+	/* Destroy it and create pools until one reuses its address */
+	object_pool_destroy(old);
+	for (pool = object_pool_create_opts(&opts); pool && pool != old;
+	     pool = object_pool_create_opts(&opts)) {
+		if (nothers == 64)
+			break;
+		others[nothers++] = pool;
+	}
+	for (int i = 0; i < nothers; i++)
+		object_pool_destroy(others[i]);
+	ASSERT_NOT_NULL(pool);
+	
+	/* Allocators with a quarantine, like ASan's, never hand it out again */
+	if (pool != old)
+		printf("  pool address not reused, only stale slots tested\n");
+	
+	/* Both threads must build new caches instead of using the stale ones */
+	s.pool = pool;
+	pthread_barrier_wait(&s.barrier);
+	obj = object_pool_alloc(pool);
+	ASSERT_NOT_NULL(obj);
+	ASSERT_EQ(*(int *)obj, 0);
+	object_pool_free(pool, obj);
+	pthread_join(thread, NULL);
+	pthread_barrier_destroy(&s.barrier);
+	
+	ASSERT_EQ(s.bad, 0);
+	ASSERT_EQ(object_pool_get_thread_stats(pool, tstats, 2), 1);
+	ASSERT_EQ(tstats[0].allocs, 1);
+	ASSERT_EQ(tstats[0].depot_refills, 1);
+	
+	object_pool_get_stats(pool, &stats);
+	ASSERT_EQ(stats.total_allocs, 5);
+	ASSERT_EQ(stats.pool_hits, 5);
+	ASSERT_EQ(stats.allocated, 0);
 	
 	object_pool_destroy(pool);
 }
@@ -179,7 +376,9 @@ TEST_SUITE_BEGIN("Object Pool")
 	RUN_TEST(object_pool_create_destroy);
 	RUN_TEST(object_pool_alloc_free);
 	RUN_TEST(object_pool_exhaustion);
-	RUN_TEST(object_pool_callbacks);
+	RUN_TEST(object_pool_zeroes_objects);
 	RUN_TEST(object_pool_reuse);
 	RUN_TEST(object_pool_concurrent);
+	RUN_TEST(object_pool_cross_thread_free);
+	RUN_TEST(object_pool_recreate_at_same_address);
 TEST_SUITE_END()
@@ -0,0 +1,449 @@
+/* test_otlp_export.c - Unit tests for the OTLP/HTTP exporter */
+
+#define _GNU_SOURCE
+#include "test_framework.h"
+#include "otlp_export.h"
+#include "event_processor.h"
+#include "resource_tracker.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <zlib.h>
+
+#define MAX_REQUESTS 32
+
+struct request {
+	char path[64];
+	bool gzip;
+	unsigned char *body;            /* Decompressed */
+	size_t len;
+};
+
+/* HTTP server answering with a status per request */
+struct server {
+	int fd;
+	uint16_t port;
+	pthread_t thread;
+	atomic_bool stop;
+	const int *statuses;            /* Status of each request, the last repeats */
+	int nstatuses;
+	pthread_mutex_t lock;
+	struct request requests[MAX_REQUESTS];
+	int count;
+};
+
+static void fill_event(struct nlmon_event *event, int i)
+{
+	memset(event, 0, sizeof(*event));
+	event->timestamp = 1700000000000000000ULL + i;
+	event->sequence = i;
+	event->event_type = 1;
+	event->message_type = 16;
+	snprintf(event->interface, sizeof(event->interface), "eth%d", i % 4);
+	event->netlink.protocol = NETLINK_ROUTE;
+	event->netlink.msg_type = 16;
+	event->netlink.seq = 1000 + i;
+}
+
+static unsigned char *gunzip(const unsigned char *data, size_t len, size_t *out_len)
+{
+	size_t cap = len * 16 + 1024;
+	unsigned char *out = malloc(cap);
+	z_stream zs;
+	
+	memset(&zs, 0, sizeof(zs));
+	if (!out || inflateInit2(&zs, 15 + 16) != Z_OK) {
+		free(out);
+		return NULL;
+	}
+	zs.next_in = (Bytef *)data;
+	zs.avail_in = (uInt)len;
+	zs.next_out = out;
+	zs.avail_out = (uInt)cap;
+	if (inflate(&zs, Z_FINISH) != Z_STREAM_END) {
+		inflateEnd(&zs);
+		free(out);
+		return NULL;
+	}
+	*out_len = zs.total_out;
+	inflateEnd(&zs);
+	return out;
+}
+
+/* Serve one connection's requests until it closes */
+static void serve(struct server *server, int fd)
+{
+	static char buf[1 << 20];
+	size_t have = 0;
+	
+	while (!atomic_load(&server->stop)) {
+		char *end, *cl;
+		size_t head, body_len;
+		ssize_t n;
+		int status;
+	
+		end = have ? memmem(buf, have, "\r\n\r\n", 4) : NULL;
+		cl = end ? strcasestr(buf, "Content-Length:") : NULL;
+		if (!end || !cl || cl > end) {
+			n = recv(fd, buf + have, sizeof(buf) - have - 1, 0);
+			if (n == 0 || (n < 0 && errno != EAGAIN))
+				return;
+			if (n > 0) {
+				have += n;
+				buf[have] = '\0';
+			}
+			continue;
+		}
+	
+		head = (size_t)(end - buf) + 4;
+		body_len = strtoul(cl + 15, NULL, 10);
+		if (have < head + body_len) {
+			n = recv(fd, buf + have, sizeof(buf) - have - 1, 0);
+			if (n == 0 || (n < 0 && errno != EAGAIN))
+				return;
+			if (n > 0)
+				have += n;
+			continue;
+		}
+	
+		pthread_mutex_lock(&server->lock);
+		if (server->count < MAX_REQUESTS) {
+			struct request *req = &server->requests[server->count];
+	
+			sscanf(buf, "POST %63s", req->path);
+			req->gzip = memmem(buf, head, "Content-Encoding: gzip", 22) != NULL;
+			if (req->gzip) {
+				req->body = gunzip((unsigned char *)buf + head, body_len, &req->len);
+			} else {
+				req->body = malloc(body_len + 1);
+				memcpy(req->body, buf + head, body_len);
+				req->len = body_len;
+			}
+		}
+		status = server->statuses[server->count < server->nstatuses ?
+		                          server->count : server->nstatuses - 1];
+		server->count++;
+		pthread_mutex_unlock(&server->lock);
+	
+		dprintf(fd, "HTTP/1.1 %d Test\r\nContent-Length: 0\r\n\r\n", status);
+		memmove(buf, buf + head + body_len, have - head - body_len);
+		have -= head + body_len;
+	}
+}
+
+static void *server_thread(void *arg)
+{
+	struct server *server = arg;
+	struct timeval tv = { .tv_usec = 50000 };
+	
+	setsockopt(server->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	while (!atomic_load(&server->stop)) {
+		int fd = accept(server->fd, NULL, NULL);
+	
+		if (fd < 0)
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		serve(server, fd);
+		close(fd);
+	}
+	return NULL;
+}
+
+static bool server_start(struct server *server, const int *statuses, int nstatuses)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	socklen_t len = sizeof(addr);
+	
+	memset(server, 0, sizeof(*server));
+	server->statuses = statuses;
+	server->nstatuses = nstatuses;
+	pthread_mutex_init(&server->lock, NULL);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	server->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (server->fd < 0 || bind(server->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(server->fd, 4) < 0 ||
+	    getsockname(server->fd, (struct sockaddr *)&addr, &len) < 0)
+		return false;
+	server->port = ntohs(addr.sin_port);
+	return pthread_create(&server->thread, NULL, server_thread, server) == 0;
+}
+
+static void server_stop(struct server *server)
+{
+	atomic_store(&server->stop, true);
+	pthread_join(server->thread, NULL);
+	close(server->fd);
+	for (int i = 0; i < server->count && i < MAX_REQUESTS; i++)
+		free(server->requests[i].body);
+	pthread_mutex_destroy(&server->lock);
+}
+
+/* Protobuf walking, enough to count nested messages */
+static bool pb_next(const unsigned char **p, const unsigned char *end, unsigned int *field,
+                    const unsigned char **val, size_t *len)
+{
+	uint64_t key = 0, v = 0;
+	int shift = 0;
+	
+	if (*p >= end)
+		return false;
+	while (*p < end) {
+		unsigned char b = *(*p)++;
+	
+		key |= (uint64_t)(b & 0x7f) << shift;
+		shift += 7;
+		if (!(b & 0x80))
+			break;
+	}
+	*field = (unsigned int)(key >> 3);
+	switch (key & 7) {
+	case 0:
+		while (*p < end && (*(*p)++ & 0x80))
+			;
+		*len = 0;
+		break;
+	case 1:
+		*p += 8;
+		*len = 0;
+		break;
+	case 2:
+		shift = 0;
+		while (*p < end) {
+			unsigned char b = *(*p)++;
+	
+			v |= (uint64_t)(b & 0x7f) << shift;
+			shift += 7;
+			if (!(b & 0x80))
+				break;
+		}
+		*val = *p;
+		*len = (size_t)v;
+		*p += v;
+		break;
+	default:
+		return false;
+	}
+	return *p <= end;
+}
+
+/* Count the items of request.1 (resource) .2 (scope) .2 (item) */
+static int count_items(const struct request *req)
+{
+	const unsigned char *p = req->body, *end = req->body + req->len;
+	const unsigned char *rv, *sv, *iv;
+	size_t rlen, slen, ilen;
+	unsigned int f;
+	int count = 0;
+	
+	while (pb_next(&p, end, &f, &rv, &rlen)) {
+		const unsigned char *rp = rv, *rend = rv + rlen;
+	
+		if (f != 1)
+			continue;
+		while (pb_next(&rp, rend, &f, &sv, &slen)) {
+			const unsigned char *sp = sv, *send = sv + slen;
+	
+			if (f != 2)
+				continue;
+			while (pb_next(&sp, send, &f, &iv, &ilen))
+				count += f == 2;
+		}
+	}
+	return count;
+}
+
+static bool body_has(const struct request *req, const char *str)
+{
+	return memmem(req->body, req->len, str, strlen(str)) != NULL;
+}
+
+/* Full batches go out at once, the rest on flush */
+TEST(otlp_logs_batched)
+{
+	static const int ok[] = { 200 };
+	struct otlp_config config = {
+		.service_name = "test-svc",
+		.node = "test-node",
+		.batch_events = 10,
+		.batch_delay_ms = 60000,
+	};
+	struct otlp_exporter *exporter;
+	struct nlmon_event event;
+	struct otlp_stats stats;
+	struct server server;
+	char endpoint[64];
+	
+	ASSERT_TRUE(server_start(&server, ok, 1));
+	snprintf(endpoint, sizeof(endpoint), "http://127.0.0.1:%u/", server.port);
+	config.endpoint = endpoint;
+	exporter = otlp_exporter_create(&config);
+	ASSERT_NOT_NULL(exporter);
+	
+	for (int i = 0; i < 25; i++) {
+		fill_event(&event, i);
+		ASSERT_TRUE(otlp_exporter_write_event(exporter, &event));
+	}
+	ASSERT_EQ(server.count, 2);
+	ASSERT_TRUE(otlp_exporter_flush(exporter));
+	otlp_exporter_get_stats(exporter, &stats);
+	otlp_exporter_destroy(exporter);
+	server_stop(&server);
+	
+	ASSERT_EQ(stats.events, 25);
+	ASSERT_EQ(stats.requests, 3);
+	ASSERT_EQ(stats.pending, 0);
+	ASSERT_EQ(server.count, 3);
+	ASSERT_STR_EQ(server.requests[0].path, "/v1/logs");
+	ASSERT_TRUE(server.requests[0].gzip);
+	ASSERT_NOT_NULL(server.requests[0].body);
+	ASSERT_EQ(count_items(&server.requests[0]), 10);
+	ASSERT_EQ(count_items(&server.requests[2]), 5);
+	ASSERT_TRUE(body_has(&server.requests[0], "test-svc"));
+	ASSERT_TRUE(body_has(&server.requests[0], "test-node"));
+	ASSERT_TRUE(body_has(&server.requests[0], "network.interface.name"));
+	ASSERT_TRUE(body_has(&server.requests[2], "eth3"));
+}
+
+/* Retryable failures are sent again after a backoff, in order */
+TEST(otlp_retry_backoff)
+{
+	static const int statuses[] = { 503, 429, 200 };
+	struct otlp_config config = {
+		.level = -1,
+		.batch_events = 5,
+		.retry_initial_ms = 20,
+		.retry_max_ms = 40,
+	};
+	struct otlp_exporter *exporter;
+	struct nlmon_event event;
+	struct otlp_stats stats;
+	struct server server;
+	char endpoint[64];
+	
+	ASSERT_TRUE(server_start(&server, statuses, 3));
+	snprintf(endpoint, sizeof(endpoint), "http://127.0.0.1:%u", server.port);
+	config.endpoint = endpoint;
+	exporter = otlp_exporter_create(&config);
+	ASSERT_NOT_NULL(exporter);
+	
+	for (int i = 0; i < 10; i++) {
+		fill_event(&event, i);
+		ASSERT_TRUE(otlp_exporter_write_event(exporter, &event));
+	}
+	otlp_exporter_get_stats(exporter, &stats);
+	ASSERT_EQ(stats.requests, 0);
+	ASSERT_EQ(stats.pending, 2);
+	
+	for (int i = 0; i < 200 && stats.pending; i++) {
+		usleep(10000);
+		otlp_exporter_tick(exporter);
+		otlp_exporter_get_stats(exporter, &stats);
+	}
+	otlp_exporter_destroy(exporter);
+	server_stop(&server);
+	
+	ASSERT_EQ(stats.pending, 0);
+	ASSERT_EQ(stats.requests, 2);
+	ASSERT_EQ(stats.retries, 2);
+	ASSERT_EQ(stats.failed, 0);
+	ASSERT_EQ(stats.dropped, 0);
+	ASSERT_EQ(server.count, 4);
+	ASSERT_FALSE(server.requests[0].gzip);
+	ASSERT_TRUE(body_has(&server.requests[2], "eth0"));
+	ASSERT_EQ(count_items(&server.requests[3]), 5);
+}
+
+/* Other failures are dropped at once */
+TEST(otlp_rejected)
+{
+	static const int bad[] = { 400 };
+	struct otlp_config config = { .batch_events = 4 };
+	struct otlp_exporter *exporter;
+	struct nlmon_event event;
+	struct otlp_stats stats;
+	struct server server;
+	char endpoint[64];
+	
+	ASSERT_TRUE(server_start(&server, bad, 1));
+	snprintf(endpoint, sizeof(endpoint), "http://127.0.0.1:%u", server.port);
+	config.endpoint = endpoint;
+	exporter = otlp_exporter_create(&config);
+	ASSERT_NOT_NULL(exporter);
+	
+	for (int i = 0; i < 8; i++) {
+		fill_event(&event, i);
+		ASSERT_TRUE(otlp_exporter_write_event(exporter, &event));
+	}
+	otlp_exporter_get_stats(exporter, &stats);
+	otlp_exporter_destroy(exporter);
+	server_stop(&server);
+	
+	ASSERT_EQ(stats.failed, 2);
+	ASSERT_EQ(stats.dropped, 8);
+	ASSERT_EQ(stats.pending, 0);
+	ASSERT_EQ(server.count, 2);
+}
+
+/* Resource tracker metrics go out every metrics interval */
+TEST(otlp_metrics)
+{
+	static const int ok[] = { 200 };
+	struct otlp_config config = { .metrics_interval_ms = 20 };
+	struct resource_tracker *tracker;
+	struct otlp_exporter *exporter;
+	struct otlp_stats stats;
+	struct server server;
+	char endpoint[64];
+	int counter, histogram;
+	
+	tracker = resource_tracker_create(0);
+	ASSERT_NOT_NULL(tracker);
+	counter = resource_tracker_register(tracker, "test_events_total", NULL, METRIC_COUNTER);
+	histogram = resource_tracker_register(tracker, "test_latency_seconds", "stage=\"parse\"",
+	                                      METRIC_HISTOGRAM);
+	ASSERT_TRUE(counter >= 0 && histogram >= 0);
+	resource_tracker_counter_add(tracker, counter, 7);
+	resource_tracker_histogram_record(tracker, histogram, 0.002);
+	resource_tracker_histogram_record(tracker, histogram, 3.0);
+	
+	ASSERT_TRUE(server_start(&server, ok, 1));
+	snprintf(endpoint, sizeof(endpoint), "http://127.0.0.1:%u", server.port);
+	config.endpoint = endpoint;
+	config.resource_tracker = tracker;
+	exporter = otlp_exporter_create(&config);
+	ASSERT_NOT_NULL(exporter);
+	
+	otlp_exporter_get_stats(exporter, &stats);
+	for (int i = 0; i < 200 && !stats.requests; i++) {
+		usleep(10000);
+		otlp_exporter_tick(exporter);
+		otlp_exporter_get_stats(exporter, &stats);
+	}
+	otlp_exporter_destroy(exporter);
+	server_stop(&server);
+	resource_tracker_destroy(tracker);
+	
+	ASSERT_TRUE(stats.requests >= 1);
+	ASSERT_TRUE(stats.metric_points >= 2);
+	ASSERT_STR_EQ(server.requests[0].path, "/v1/metrics");
+	ASSERT_TRUE(count_items(&server.requests[0]) >= 2);
+	ASSERT_TRUE(body_has(&server.requests[0], "test_events_total"));
+	ASSERT_TRUE(body_has(&server.requests[0], "test_latency_seconds"));
+	ASSERT_TRUE(body_has(&server.requests[0], "parse"));
+}
+
+TEST_SUITE_BEGIN("OTLP Export")
+	RUN_TEST(otlp_logs_batched);
+	RUN_TEST(otlp_retry_backoff);
+	RUN_TEST(otlp_rejected);
+	RUN_TEST(otlp_metrics);
+TEST_SUITE_END()
@@ -0,0 +1,303 @@
+/* test_pcap_export.c - Unit tests for pcap and pcapng export */
+
+#include "test_framework.h"
+#include "pcap_export.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_PCAP "/tmp/test_unit_pcap_export.pcap"
+
+/* What read_pcapng() found in a file */
+struct pcapng_contents {
+	int sections;
+	int interfaces;
+	int packets;
+	int comments;
+	uint32_t packet_interface[64];  /* Interface ID of the first packets */
+	char interface_name[8][16];
+};
+
+static unsigned char *read_file(const char *path, size_t *size)
+{
+	FILE *fp = fopen(path, "rb");
+	unsigned char *data;
+	long len;
+	
+	if (!fp)
+		return NULL;
+	
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	data = malloc(len ? len : 1);
+	if (data && fread(data, 1, len, fp) != (size_t)len) {
+		free(data);
+		data = NULL;
+	}
+	
+	fclose(fp);
+	*size = len;
+	return data;
+}
+
+/* Walk the blocks of a pcapng file, false if one is malformed */
+static bool read_pcapng(const char *path, struct pcapng_contents *contents)
+{
+	size_t size, pos = 0;
+	unsigned char *data = read_file(path, &size);
+	bool ok = data != NULL;
+	
+	memset(contents, 0, sizeof(*contents));
+	
+	while (ok && pos < size) {
+		uint32_t type, len, trailer;
+		
+		if (size - pos < 12) {
+			ok = false;
+			break;
+		}
+		memcpy(&type, data + pos, 4);
+		memcpy(&len, data + pos + 4, 4);
+		if (len < 12 || len % 4 || len > size - pos) {
+			ok = false;
+			break;
+		}
+		memcpy(&trailer, data + pos + len - 4, 4);
+		if (trailer != len) {
+			ok = false;
+			break;
+		}
+		
+		if (type == 0x0A0D0D0A) {
+			uint32_t magic;
+			
+			memcpy(&magic, data + pos + 8, 4);
+			ok = magic == 0x1A2B3C4D;
+			contents->sections++;
+		} else if (type == 1) {
+			uint16_t code, opt_len;
+			
+			/* if_name is the first option */
+			memcpy(&code, data + pos + 16, 2);
+			memcpy(&opt_len, data + pos + 18, 2);
+			ok = code == 2 && opt_len < 16;
+			if (ok && contents->interfaces < 8)
+				memcpy(contents->interface_name[contents->interfaces], data + pos + 20, opt_len);
+			contents->interfaces++;
+		} else if (type == 6) {
+			uint32_t id, caplen;
+			
+			memcpy(&id, data + pos + 8, 4);
+			memcpy(&caplen, data + pos + 20, 4);
+			if (contents->packets < 64)
+				contents->packet_interface[contents->packets] = id;
+			contents->packets++;
+			
+			/* An options area beyond the end marker holds the comment */
+			if (len > 28 + ((caplen + 3) & ~3u) + 8)
+				contents->comments++;
+		} else {
+			ok = false;
+		}
+		
+		pos += len;
+	}
+	
+	free(data);
+	return ok;
+}
+
+TEST(pcap_export_classic)
+{
+	struct pcap_exporter *exporter;
+	unsigned char payload[100];
+	unsigned char *data;
+	uint64_t packets;
+	size_t size;
+	
+	memset(payload, 0xab, sizeof(payload));
+	exporter = pcap_exporter_create(TEST_PCAP, NULL);
+	ASSERT_NOT_NULL(exporter);
+	
+	for (int i = 0; i < 1000; i++)
+		ASSERT_TRUE(pcap_exporter_write_packet(exporter, payload, 20 + i % 80));
+	ASSERT_TRUE(pcap_exporter_get_stats(exporter, &packets, NULL, NULL, NULL));
+	ASSERT_EQ(packets, 1000);
+	pcap_exporter_destroy(exporter);
+	
+	data = read_file(TEST_PCAP, &size);
+	ASSERT_NOT_NULL(data);
+	
+	/* File header, then each record header and payload */
+	size_t expected = 24, pos = 24;
+	for (int i = 0; i < 1000; i++)
+		expected += 16 + 20 + i % 80;
+	ASSERT_EQ(size, expected);
+	
+	for (int i = 0; i < 1000; i++) {
+		uint32_t incl_len;
+		
+		memcpy(&incl_len, data + pos + 8, 4);
+		ASSERT_EQ(incl_len, (uint32_t)(20 + i % 80));
+		pos += 16 + incl_len;
+	}
+	
+	free(data);
+	unlink(TEST_PCAP);
+}
+
+TEST(pcap_export_pcapng_interfaces)
+{
+	static const char *names[] = { NULL, "eth0", "wlan0", "eth0", "" };
+	struct pcap_export_options options = {
+		.format = PCAP_FORMAT_PCAPNG,
+		.buffer_size = 4096,
+	};
+	struct pcapng_contents contents;
+	struct pcap_exporter *exporter;
+	unsigned char payload[3000];
+	
+	memset(payload, 0x5a, sizeof(payload));
+	exporter = pcap_exporter_create_with_options(TEST_PCAP, NULL, &options);
+	ASSERT_NOT_NULL(exporter);
+	
+	/* Every fifth payload is big enough to bypass the buffer */
+	for (int i = 0; i < 50; i++) {
+		struct pcap_packet_info info = {
+			.timestamp_ns = 1700000000000000000ULL + i,
+			.interface = names[i % 5],
+			.comment = i % 2 ? "event_type=1 seq=7" : NULL,
+		};
+		
+		ASSERT_TRUE(pcap_exporter_write_packet_info(exporter, payload,
+		                                            i % 5 == 4 ? 3000 : 1 + i, &info));
+	}
+	
+	pcap_exporter_destroy(exporter);
+	
+	ASSERT_TRUE(read_pcapng(TEST_PCAP, &contents));
+	ASSERT_EQ(contents.sections, 1);
+	ASSERT_EQ(contents.interfaces, 3);
+	ASSERT_STR_EQ(contents.interface_name[0], "nlmon");
+	ASSERT_STR_EQ(contents.interface_name[1], "eth0");
+	ASSERT_STR_EQ(contents.interface_name[2], "wlan0");
+	ASSERT_EQ(contents.packets, 50);
+	ASSERT_EQ(contents.comments, 25);
+	ASSERT_EQ(contents.packet_interface[0], 0);
+	ASSERT_EQ(contents.packet_interface[1], 1);
+	ASSERT_EQ(contents.packet_interface[2], 2);
+	ASSERT_EQ(contents.packet_interface[3], 1);
+	ASSERT_EQ(contents.packet_interface[4], 0);
+	
+	unlink(TEST_PCAP);
+}
+
+TEST(pcap_export_direct_io)
+{
+	struct pcap_export_options options = {
+		.format = PCAP_FORMAT_PCAPNG,
+		.buffer_size = 8192,
+	};
+	struct pcapng_contents contents;
+	struct pcap_exporter *exporter;
+	unsigned char payload[5000];
+	unsigned char *buffered, *direct;
+	size_t buffered_size, direct_size;
+	
+	for (size_t i = 0; i < sizeof(payload); i++)
+		payload[i] = (unsigned char)i;
+	
+	/* The same packets with and without O_DIRECT give the same file */
+	for (int pass = 0; pass < 2; pass++) {
+		options.direct_io = pass == 1;
+		exporter = pcap_exporter_create_with_options(TEST_PCAP, NULL, &options);
+		ASSERT_NOT_NULL(exporter);
+		
+		for (int i = 0; i < 300; i++) {
+			struct pcap_packet_info info = {
+				.timestamp_ns = 1000 + i,
+				.interface = i % 3 ? "eth1" : NULL,
+				.comment = "annotated",
+			};
+			
+			ASSERT_TRUE(pcap_exporter_write_packet_info(exporter, payload,
+			                                            (i * 37) % sizeof(payload) + 1, &info));
+			
+			/* Flushes leave a partial page that later writes complete */
+			if (i % 50 == 0)
+				ASSERT_TRUE(pcap_exporter_flush(exporter));
+		}
+		
+		pcap_exporter_destroy(exporter);
+		ASSERT_TRUE(read_pcapng(TEST_PCAP, &contents));
+		ASSERT_EQ(contents.packets, 300);
+		
+		if (pass == 0) {
+			buffered = read_file(TEST_PCAP, &buffered_size);
+			ASSERT_NOT_NULL(buffered);
+		}
+	}
+	
+	direct = read_file(TEST_PCAP, &direct_size);
+	ASSERT_NOT_NULL(direct);
+	ASSERT_EQ(direct_size, buffered_size);
+	ASSERT_TRUE(memcmp(direct, buffered, direct_size) == 0);
+	
+	free(direct);
+	free(buffered);
+	unlink(TEST_PCAP);
+}
+
+TEST(pcap_export_pcapng_rotation)
+{
+	struct pcap_rotation_policy policy = {
+		.max_file_size = 16 * 1024,
+		.max_rotations = 2,
+	};
+	struct pcap_export_options options = {
+		.format = PCAP_FORMAT_PCAPNG,
+	};
+	struct pcapng_contents contents;
+	struct pcap_exporter *exporter;
+	unsigned char payload[200] = {0};
+	uint32_t rotations;
+	int packets = 0;
+	
+	exporter = pcap_exporter_create_with_options(TEST_PCAP, &policy, &options);
+	ASSERT_NOT_NULL(exporter);
+	
+	for (int i = 0; i < 300; i++) {
+		struct pcap_packet_info info = { .interface = "eth2" };
+		
+		ASSERT_TRUE(pcap_exporter_write_packet_info(exporter, payload, sizeof(payload), &info));
+	}
+	ASSERT_TRUE(pcap_exporter_get_stats(exporter, NULL, NULL, NULL, &rotations));
+	ASSERT_TRUE(rotations >= 2);
+	pcap_exporter_destroy(exporter);
+	
+	/* Each file is a section of its own that describes its interfaces again */
+	ASSERT_TRUE(read_pcapng(TEST_PCAP, &contents));
+	ASSERT_EQ(contents.sections, 1);
+	ASSERT_EQ(contents.interfaces, 2);
+	packets += contents.packets;
+	ASSERT_TRUE(read_pcapng(TEST_PCAP ".0", &contents));
+	ASSERT_EQ(contents.sections, 1);
+	ASSERT_EQ(contents.interfaces, 2);
+	ASSERT_TRUE(contents.packets > 0);
+	packets += contents.packets;
+	ASSERT_TRUE(packets <= 300);
+	
+	unlink(TEST_PCAP);
+	unlink(TEST_PCAP ".0");
+	unlink(TEST_PCAP ".1");
+	unlink(TEST_PCAP ".2");
+}
+
+TEST_SUITE_BEGIN("PCAP Export")
+	RUN_TEST(pcap_export_classic);
+	RUN_TEST(pcap_export_pcapng_interfaces);
+	RUN_TEST(pcap_export_direct_io);
+	RUN_TEST(pcap_export_pcapng_rotation);
+TEST_SUITE_END()
@@ -0,0 +1,278 @@
+/* test_performance_profiler.c - Unit tests for probes and event latency tracing */
+
+#include "test_framework.h"
+#include "performance_profiler.h"
+#include "stack_sampler.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#define NS_PER_MS 1000000ULL
+#define PROBE_THREADS 8
+#define PROBES_PER_THREAD 100000
+
+struct probe_arg {
+	struct performance_profiler *profiler;
+	int op;
+};
+
+static void *probe_thread(void *data)
+{
+	struct probe_arg *arg = data;
+	
+	for (int i = 0; i < PROBES_PER_THREAD; i++)
+		performance_profiler_probe(arg->profiler, arg->op, performance_profiler_ticks());
+	return NULL;
+}
+
+static _Atomic bool spinning;
+
+/* Named in the stack samples, the test is linked with -rdynamic */
+__attribute__((noinline)) void profiled_spin(void)
+{
+	volatile uint64_t x = 0;
+	
+	while (atomic_load_explicit(&spinning, memory_order_relaxed))
+		x++;
+}
+
+static void *spin_thread(void *data)
+{
+	profiled_spin();
+	return NULL;
+}
+
+/* An event received @age_ms ago that reached the stages up to handler */
+static void trace_event(struct nlmon_event_trace *trace, uint64_t age_ms)
+{
+	nlmon_trace_begin(trace, nlmon_trace_now() - age_ms * NS_PER_MS);
+	nlmon_trace_stamp(trace, NLMON_TRACE_PARSE);
+	nlmon_trace_stamp(trace, NLMON_TRACE_SUBMIT);
+	nlmon_trace_stamp(trace, NLMON_TRACE_DISPATCH);
+	nlmon_trace_stamp(trace, NLMON_TRACE_STORAGE);
+}
+
+TEST(trace_stages)
+{
+	struct performance_profiler *profiler = performance_profiler_create(0, 10.0);
+	struct nlmon_event_trace trace, copy;
+	struct trace_stats stats;
+	static char buffer[65536];
+	const char *prefix = "{\"traceEvents\":[{\"name\":\"event\"";
+	ssize_t len;
+	
+	ASSERT_NOT_NULL(profiler);
+	ASSERT_EQ(performance_profiler_enable_tracing(profiler, 1), 0);
+	ASSERT_TRUE(nlmon_trace_enabled());
+	
+	/* A fast event, exported later from a copy */
+	trace_event(&trace, 1);
+	ASSERT_TRUE(trace.recv_ns != 0);
+	ASSERT_TRUE(trace.flags & NLMON_TRACE_SAMPLED);
+	ASSERT_EQ(trace.offset_ns[NLMON_TRACE_FILTER], 0);
+	copy = trace;
+	nlmon_trace_finish(&trace, NLMON_TRACE_HANDLER);
+	ASSERT_EQ(trace.recv_ns, 0);
+	nlmon_trace_report(&copy, NLMON_TRACE_EXPORT);
+	
+	/* Reported once only */
+	nlmon_trace_finish(&trace, NLMON_TRACE_HANDLER);
+	
+	/* A slow one */
+	trace_event(&trace, 50);
+	nlmon_trace_finish(&trace, NLMON_TRACE_HANDLER);
+	
+	ASSERT_TRUE(performance_profiler_get_trace_stats(profiler, &stats));
+	ASSERT_EQ(stats.traced, 2);
+	ASSERT_EQ(stats.sampled, 2);
+	ASSERT_EQ(stats.outliers, 1);
+	ASSERT_EQ(stats.stages[NLMON_TRACE_PARSE].count, 2);
+	ASSERT_EQ(stats.stages[NLMON_TRACE_FILTER].count, 0);
+	ASSERT_EQ(stats.stages[NLMON_TRACE_EXPORT].count, 1);
+	ASSERT_EQ(stats.stages[NLMON_TRACE_HANDLER].slow_count, 1);
+	ASSERT_TRUE(stats.stages[NLMON_TRACE_HANDLER].max_ms >= 50.0);
+	ASSERT_TRUE(stats.stages[NLMON_TRACE_HANDLER].p50_ms >= 1.0);
+	
+	/* Events on their own rows, the export merged into the first */
+	len = performance_profiler_export_chrome_trace(profiler, buffer, sizeof(buffer));
+	ASSERT_TRUE(len > 0);
+	ASSERT_EQ((size_t)len, strlen(buffer));
+	ASSERT_TRUE(strncmp(buffer, prefix, strlen(prefix)) == 0);
+	ASSERT_NOT_NULL(strstr(buffer, "\"name\":\"export\""));
+	ASSERT_NOT_NULL(strstr(buffer, "\"name\":\"storage\""));
+	ASSERT_NULL(strstr(buffer, "\"name\":\"filter\""));
+	ASSERT_NOT_NULL(strstr(buffer, "\"outlier\":true"));
+	ASSERT_NOT_NULL(strstr(buffer, "\"outlier\":false"));
+	ASSERT_NOT_NULL(strstr(buffer, "]"));
+	
+	performance_profiler_reset(profiler);
+	ASSERT_TRUE(performance_profiler_get_trace_stats(profiler, &stats));
+	ASSERT_EQ(stats.traced, 0);
+	ASSERT_EQ(stats.stages[NLMON_TRACE_PARSE].count, 0);
+	ASSERT_EQ(performance_profiler_export_chrome_trace(profiler, buffer, sizeof(buffer)),
+	          (ssize_t)strlen("{\"traceEvents\":[],\"displayTimeUnit\":\"ns\"}"));
+	
+	performance_profiler_destroy(profiler);
+	ASSERT_FALSE(nlmon_trace_enabled());
+}
+
+TEST(trace_sampling)
+{
+	struct performance_profiler *profiler = performance_profiler_create(0, 1000.0);
+	struct nlmon_event_trace trace;
+	struct trace_stats stats;
+	static char buffer[4096];
+	ssize_t len;
+	
+	ASSERT_NOT_NULL(profiler);
+	
+	/* Nothing is traced without a sink */
+	trace_event(&trace, 1);
+	ASSERT_EQ(trace.recv_ns, 0);
+	
+	ASSERT_EQ(performance_profiler_enable_tracing(profiler, 10), 0);
+	for (int i = 0; i < 1000; i++) {
+		trace_event(&trace, 0);
+		nlmon_trace_finish(&trace, NLMON_TRACE_HANDLER);
+	}
+	
+	ASSERT_TRUE(performance_profiler_get_trace_stats(profiler, &stats));
+	ASSERT_EQ(stats.traced, 1000);
+	ASSERT_EQ(stats.sampled, 100);
+	ASSERT_EQ(stats.outliers, 0);
+	ASSERT_EQ(stats.stages[NLMON_TRACE_RECV].count, 1000);
+	
+	/* Only whole events that fit are written */
+	len = performance_profiler_export_chrome_trace(profiler, buffer, sizeof(buffer));
+	ASSERT_TRUE(len > 0 && (size_t)len < sizeof(buffer));
+	ASSERT_EQ((size_t)len, strlen(buffer));
+	ASSERT_TRUE(strcmp(buffer + len - 2, "\"}") == 0);
+	ASSERT_EQ(performance_profiler_export_chrome_trace(profiler, buffer, 8), -1);
+	
+	performance_profiler_disable_tracing(profiler);
+	ASSERT_FALSE(nlmon_trace_enabled());
+	trace_event(&trace, 1);
+	ASSERT_EQ(trace.recv_ns, 0);
+	
+	performance_profiler_destroy(profiler);
+}
+
+TEST(probe_operations)
+{
+	struct performance_profiler *profiler = performance_profiler_create(0, 50.0);
+	struct timespec pause = { .tv_sec = 0, .tv_nsec = 2 * NS_PER_MS };
+	struct profile_stats stats;
+	uint64_t start;
+	int op;
+	
+	ASSERT_NOT_NULL(profiler);
+	
+	op = performance_profiler_register(profiler, "parse");
+	ASSERT_TRUE(op >= 0);
+	ASSERT_EQ(performance_profiler_register(profiler, "parse"), op);
+	ASSERT_NE(performance_profiler_register(profiler, "dispatch"), op);
+	
+	/* Ticks come out in wall time */
+	start = PROFILE_PROBE_START();
+	nanosleep(&pause, NULL);
+	PROFILE_PROBE_END(profiler, op, start);
+	ASSERT_TRUE(performance_profiler_get_stats(profiler, "parse", &stats));
+	ASSERT_EQ(stats.sample_count, 1);
+	ASSERT_TRUE(stats.min_time_ms >= 1.9 && stats.min_time_ms < 40.0);
+	
+	/* Durations by name, 1 to 100ms */
+	for (int i = 1; i <= 100; i++)
+		performance_profiler_record(profiler, "storage", i * NS_PER_MS, NULL);
+	ASSERT_TRUE(performance_profiler_get_stats(profiler, "storage", &stats));
+	ASSERT_EQ(stats.sample_count, 100);
+	ASSERT_TRUE(stats.total_time_ms > 5049.9 && stats.total_time_ms < 5050.1);
+	ASSERT_TRUE(stats.p50_time_ms > 47.0 && stats.p50_time_ms < 53.0);
+	ASSERT_TRUE(stats.p99_time_ms > 94.0 && stats.p99_time_ms <= 100.0);
+	ASSERT_EQ(stats.slow_count, 50);
+	
+	/* Registered without samples */
+	ASSERT_TRUE(performance_profiler_get_stats(profiler, "dispatch", &stats));
+	ASSERT_EQ(stats.sample_count, 0);
+	ASSERT_FALSE(performance_profiler_get_stats(profiler, "export", &stats));
+	
+	performance_profiler_reset(profiler);
+	ASSERT_TRUE(performance_profiler_get_stats(profiler, "storage", &stats));
+	ASSERT_EQ(stats.sample_count, 0);
+	ASSERT_EQ(performance_profiler_get_dropped(profiler), 0);
+	
+	performance_profiler_destroy(profiler);
+}
+
+TEST(probe_concurrent)
+{
+	struct performance_profiler *profiler = performance_profiler_create(0, 0);
+	pthread_t threads[PROBE_THREADS];
+	struct probe_arg arg;
+	struct profile_stats stats;
+	
+	ASSERT_NOT_NULL(profiler);
+	
+	arg.profiler = profiler;
+	arg.op = performance_profiler_register(profiler, "handler");
+	ASSERT_TRUE(arg.op >= 0);
+	
+	for (int i = 0; i < PROBE_THREADS; i++)
+		ASSERT_EQ(pthread_create(&threads[i], NULL, probe_thread, &arg), 0);
+	for (int i = 0; i < PROBE_THREADS; i++)
+		pthread_join(threads[i], NULL);
+	
+	/* Every probe is merged or counted as dropped */
+	ASSERT_TRUE(performance_profiler_get_stats(profiler, "handler", &stats));
+	ASSERT_TRUE(stats.sample_count > 0);
+	ASSERT_EQ(stats.sample_count + performance_profiler_get_dropped(profiler),
+	          (uint64_t)PROBE_THREADS * PROBES_PER_THREAD);
+	
+	performance_profiler_destroy(profiler);
+}
+
+TEST(bottlenecks_from_samples)
+{
+	struct performance_profiler *profiler = performance_profiler_create(0, 1000.0);
+	struct bottleneck_info bottlenecks[4];
+	struct stack_profile *profile;
+	pthread_t spinner;
+	
+	ASSERT_NOT_NULL(profiler);
+	
+	/* Timed operations that take no time of their own */
+	performance_profiler_register(profiler, "profiled_spin");
+	performance_profiler_record(profiler, "idle", 1000, NULL);
+	ASSERT_EQ(performance_profiler_detect_bottlenecks(profiler, bottlenecks, 4), 1);
+	ASSERT_TRUE(strcmp(bottlenecks[0].operation, "idle") == 0);
+	ASSERT_TRUE(bottlenecks[0].cpu_percentage < 0);
+	
+	atomic_store(&spinning, true);
+	ASSERT_EQ(pthread_create(&spinner, NULL, spin_thread, NULL), 0);
+	profile = stack_sampler_capture(1, 200);
+	atomic_store(&spinning, false);
+	pthread_join(spinner, NULL);
+	ASSERT_NOT_NULL(profile);
+	
+	/* The samples show where the CPU went */
+	performance_profiler_attach_samples(profiler, profile);
+	stack_profile_free(profile);
+	ASSERT_EQ(performance_profiler_detect_bottlenecks(profiler, bottlenecks, 4), 2);
+	ASSERT_TRUE(strcmp(bottlenecks[0].operation, "profiled_spin") == 0);
+	ASSERT_TRUE(bottlenecks[0].cpu_percentage > 80.0);
+	ASSERT_EQ(bottlenecks[0].sample_count, 0);
+	ASSERT_TRUE(bottlenecks[1].cpu_percentage < 10.0);
+	
+	performance_profiler_reset(profiler);
+	ASSERT_EQ(performance_profiler_detect_bottlenecks(profiler, bottlenecks, 4), 0);
+	
+	performance_profiler_destroy(profiler);
+}
+
+TEST_SUITE_BEGIN("Performance Profiler")
+	RUN_TEST(trace_stages);
+	RUN_TEST(trace_sampling);
+	RUN_TEST(probe_operations);
+	RUN_TEST(probe_concurrent);
+	RUN_TEST(bottlenecks_from_samples);
+TEST_SUITE_END()
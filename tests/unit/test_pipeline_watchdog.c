@@ -0,0 +1,235 @@
+/* test_pipeline_watchdog.c - Unit tests for the pipeline stall watchdog */
+
+#include "test_framework.h"
+#include "pipeline_watchdog.h"
+#include "thread_pool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* A stage that blocks until released */
+static pthread_mutex_t wedge_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wedge_cond = PTHREAD_COND_INITIALIZER;
+static bool wedge_released;
+static _Atomic bool wedge_entered;
+
+static void wedge_reset(void)
+{
+	wedge_released = false;
+	atomic_store(&wedge_entered, false);
+}
+
+static void wedge(void)
+{
+	atomic_store(&wedge_entered, true);
+	pthread_mutex_lock(&wedge_lock);
+	while (!wedge_released)
+		pthread_cond_wait(&wedge_cond, &wedge_lock);
+	pthread_mutex_unlock(&wedge_lock);
+}
+
+static void wedge_release(void)
+{
+	pthread_mutex_lock(&wedge_lock);
+	wedge_released = true;
+	pthread_cond_broadcast(&wedge_cond);
+	pthread_mutex_unlock(&wedge_lock);
+}
+
+static void wedge_wait_entered(void)
+{
+	while (!atomic_load(&wedge_entered))
+		usleep(1000);
+}
+
+/* Last stall reported */
+struct stall_record {
+	_Atomic int count;
+	char name[32];
+	char stage[32];
+	bool has_stack;
+	bool restarted;
+};
+
+static void record_stall(const struct nlmon_stall *stall, void *ctx)
+{
+	struct stall_record *record = ctx;
+	
+	record->count++;
+	snprintf(record->name, sizeof(record->name), "%s", stall->name);
+	snprintf(record->stage, sizeof(record->stage), "%s", stall->stage);
+	record->has_stack = stall->stack && strchr(stall->stack, '\n');
+	record->restarted = stall->restarted;
+}
+
+static _Atomic bool waiter_stop;
+
+static void *wedged_thread(void *arg)
+{
+	const char *prev;
+	
+	(void)arg;
+	nlmon_heartbeat_register("test-wedged", NULL, NULL);
+	prev = nlmon_heartbeat_enter("wedged");
+	wedge();
+	nlmon_heartbeat_leave(prev);
+	
+	/* Waiting for work never stalls */
+	while (!atomic_load(&waiter_stop))
+		usleep(1000);
+	nlmon_heartbeat_unregister();
+	return NULL;
+}
+
+TEST(watchdog_stall)
+{
+	struct stall_record record = { 0 };
+	struct nlmon_watchdog_config config = {
+		.stall_ms = 50,
+		.on_stall = record_stall,
+		.ctx = &record,
+	};
+	pthread_t thread;
+	
+	wedge_reset();
+	atomic_store(&waiter_stop, false);
+	ASSERT_EQ(pthread_create(&thread, NULL, wedged_thread, NULL), 0);
+	wedge_wait_entered();
+	
+	/* Reported once past the threshold, with its stack */
+	ASSERT_EQ(nlmon_watchdog_check(&config), 0);
+	usleep(80000);
+	ASSERT_EQ(nlmon_watchdog_check(&config), 1);
+	ASSERT_EQ(record.count, 1);
+	ASSERT_STR_EQ(record.name, "test-wedged");
+	ASSERT_STR_EQ(record.stage, "wedged");
+	ASSERT_TRUE(record.has_stack);
+	ASSERT_FALSE(record.restarted);
+	
+	/* Not again while it stays stalled */
+	usleep(80000);
+	ASSERT_EQ(nlmon_watchdog_check(&config), 0);
+	
+	/* Idle once released, however long */
+	wedge_release();
+	usleep(80000);
+	ASSERT_EQ(nlmon_watchdog_check(&config), 0);
+	usleep(80000);
+	ASSERT_EQ(nlmon_watchdog_check(&config), 0);
+	ASSERT_EQ(record.count, 1);
+	
+	atomic_store(&waiter_stop, true);
+	pthread_join(thread, NULL);
+}
+
+static void wedge_task(void *arg)
+{
+	(void)arg;
+	wedge();
+}
+
+static _Atomic int ran;
+
+static void count_task(void *arg)
+{
+	(void)arg;
+	atomic_fetch_add(&ran, 1);
+}
+
+TEST(watchdog_restart)
+{
+	struct stall_record record = { 0 };
+	struct nlmon_watchdog_config config = {
+		.stall_ms = 50,
+		.restart = true,
+		.on_stall = record_stall,
+		.ctx = &record,
+	};
+	struct thread_pool_options opts;
+	struct thread_pool *pool;
+	
+	memset(&opts, 0, sizeof(opts));
+	opts.num_threads = 1;
+	opts.min_threads = 1;
+	opts.max_threads = 2;
+	opts.target_wait_us = 1000000;
+	opts.name = "test-pool";
+	pool = thread_pool_create_opts(&opts);
+	ASSERT_NOT_NULL(pool);
+	
+	/* The only worker wedges */
+	wedge_reset();
+	ASSERT_TRUE(thread_pool_submit(pool, wedge_task, NULL, PRIORITY_NORMAL));
+	wedge_wait_entered();
+	nlmon_watchdog_check(&config);
+	usleep(80000);
+	ASSERT_EQ(nlmon_watchdog_check(&config), 1);
+	ASSERT_STR_EQ(record.name, "test-pool-0");
+	ASSERT_STR_EQ(record.stage, "task");
+	ASSERT_TRUE(record.restarted);
+	ASSERT_EQ(thread_pool_get_thread_count(pool), 2);
+	
+	/* Its replacement takes the work */
+	atomic_store(&ran, 0);
+	ASSERT_TRUE(thread_pool_submit(pool, count_task, NULL, PRIORITY_NORMAL));
+	for (int i = 0; i < 1000 && atomic_load(&ran) == 0; i++)
+		usleep(1000);
+	ASSERT_EQ(atomic_load(&ran), 1);
+	
+	wedge_release();
+	thread_pool_destroy(pool, true);
+}
+
+static void count_threads(const struct nlmon_heartbeat_stats *stats, void *ctx)
+{
+	int *count = ctx;
+	
+	if (strcmp(stats->name, "test-wedged") == 0)
+		(*count)++;
+}
+
+TEST(watchdog_thread)
+{
+	struct stall_record record = { 0 };
+	struct nlmon_watchdog_config config = {
+		.stall_ms = 50,
+		.interval_ms = 10,
+		.on_stall = record_stall,
+		.ctx = &record,
+	};
+	pthread_t thread;
+	int threads = 0;
+	
+	wedge_reset();
+	atomic_store(&waiter_stop, false);
+	ASSERT_EQ(nlmon_watchdog_start(&config), 0);
+	ASSERT_EQ(nlmon_watchdog_start(&config), -1);
+	ASSERT_EQ(pthread_create(&thread, NULL, wedged_thread, NULL), 0);
+	wedge_wait_entered();
+	
+	nlmon_watchdog_for_each(count_threads, &threads);
+	ASSERT_EQ(threads, 1);
+	
+	for (int i = 0; i < 1000 && record.count == 0; i++)
+		usleep(1000);
+	nlmon_watchdog_stop();
+	ASSERT_EQ(record.count, 1);
+	ASSERT_STR_EQ(record.stage, "wedged");
+	
+	wedge_release();
+	atomic_store(&waiter_stop, true);
+	pthread_join(thread, NULL);
+	
+	/* Gone once it unregistered */
+	threads = 0;
+	nlmon_watchdog_for_each(count_threads, &threads);
+	ASSERT_EQ(threads, 0);
+}
+
+TEST_SUITE_BEGIN("Pipeline Watchdog")
+	RUN_TEST(watchdog_stall);
+	RUN_TEST(watchdog_restart);
+	RUN_TEST(watchdog_thread);
+TEST_SUITE_END()
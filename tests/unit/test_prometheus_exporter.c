@@ -0,0 +1,763 @@
+/* test_prometheus_exporter.c - Unit tests for the Prometheus exporter */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "test_framework.h"
+#include "prometheus_exporter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+
+#define SCRAPE_SIZE (256 * 1024)
+
+static int connect_exporter(struct prometheus_exporter *exporter)
+{
+	struct sockaddr_in addr;
+	int sock;
+	
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0)
+		return -1;
+	
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(prometheus_exporter_get_port(exporter));
+	
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(sock);
+		return -1;
+	}
+	
+	return sock;
+}
+
+/* GET the metrics page with an Accept header, returns the body or NULL */
+static char *scrape_accept(struct prometheus_exporter *exporter, char *buf, size_t size,
+                           const char *accept, size_t *body_len)
+{
+	char request[256];
+	size_t len = 0;
+	ssize_t n;
+	char *body;
+	int sock;
+	
+	sock = connect_exporter(exporter);
+	if (sock < 0)
+		return NULL;
+	
+	snprintf(request, sizeof(request),
+	         "GET /metrics HTTP/1.1\r\nHost: localhost\r\nAccept: %s\r\n"
+	         "Connection: close\r\n\r\n", accept);
+	if (send(sock, request, strlen(request), 0) < 0) {
+		close(sock);
+		return NULL;
+	}
+	
+	while (len < size - 1 && (n = recv(sock, buf + len, size - 1 - len, 0)) > 0)
+		len += (size_t)n;
+	buf[len] = '\0';
+	close(sock);
+	
+	if (strncmp(buf, "HTTP/1.1 200 OK", 15) != 0)
+		return NULL;
+	
+	body = strstr(buf, "\r\n\r\n");
+	if (!body)
+		return NULL;
+	
+	body += 4;
+	if (body_len)
+		*body_len = len - (size_t)(body - buf);
+	return body;
+}
+
+static char *scrape(struct prometheus_exporter *exporter, char *buf, size_t size)
+{
+	return scrape_accept(exporter, buf, size, "text/plain", NULL);
+}
+
+/* Read one response of a kept-alive connection, returns the body length or -1 */
+static ssize_t read_response(int sock, char *buf, size_t size, char **body)
+{
+	size_t len = 0, content_len;
+	const char *field;
+	char *end;
+	ssize_t n;
+	
+	while (!(end = memmem(buf, len, "\r\n\r\n", 4))) {
+		if (len == size - 1 || (n = recv(sock, buf + len, size - 1 - len, 0)) <= 0)
+			return -1;
+		len += (size_t)n;
+	}
+	
+	buf[len] = '\0';
+	field = strstr(buf, "Content-Length: ");
+	if (!field || field > end)
+		return -1;
+	content_len = strtoul(field + 16, NULL, 10);
+	
+	*body = end + 4;
+	while ((size_t)(*body - buf) + content_len > len) {
+		if (len == size - 1 || (n = recv(sock, buf + len, size - 1 - len, 0)) <= 0)
+			return -1;
+		len += (size_t)n;
+	}
+	
+	/* Nothing of a next response is read yet, requests are sent one at a time */
+	buf[len] = '\0';
+	return (ssize_t)content_len;
+}
+
+static int count_lines(const char *text, const char *prefix)
+{
+	size_t len = strlen(prefix);
+	int count = 0;
+	
+	while (text && *text) {
+		if (strncmp(text, prefix, len) == 0)
+			count++;
+		text = strchr(text, '\n');
+		if (text)
+			text++;
+	}
+	
+	return count;
+}
+
+TEST(prometheus_register_handles)
+{
+	struct prometheus_exporter *exporter = prometheus_exporter_create(0, "/metrics");
+	struct prometheus_metric *a, *b, *c;
+	char *buf = malloc(SCRAPE_SIZE);
+	char *body;
+	
+	ASSERT_NOT_NULL(exporter);
+	ASSERT_NOT_NULL(buf);
+	ASSERT_NE(prometheus_exporter_get_port(exporter), 0);
+	prometheus_exporter_set_cache_interval(exporter, 0);
+	
+	a = prometheus_exporter_register(exporter, "test_events_total", "type=\"1\"",
+	                                 METRIC_TYPE_COUNTER);
+	b = prometheus_exporter_register(exporter, "test_events_total", "type=\"2\"",
+	                                 METRIC_TYPE_COUNTER);
+	c = prometheus_exporter_register(exporter, "test_events_total", "type=\"1\"",
+	                                 METRIC_TYPE_COUNTER);
+	ASSERT_NOT_NULL(a);
+	ASSERT_NOT_NULL(b);
+	ASSERT_TRUE(a != b);
+	ASSERT_TRUE(a == c);
+	
+	/* Same series with another type is refused */
+	ASSERT_NULL(prometheus_exporter_register(exporter, "test_events_total", "type=\"1\"",
+	                                         METRIC_TYPE_GAUGE));
+	
+	prometheus_metric_inc(a, 3);
+	prometheus_exporter_inc_counter(exporter, "test_events_total", "type=\"1\"", 2);
+	prometheus_metric_inc(b, 1);
+	prometheus_exporter_set_gauge(exporter, "test_gauge", NULL, 2.5);
+	prometheus_exporter_observe_histogram(exporter, "test_latency", NULL, 0.003);
+	prometheus_exporter_observe_histogram(exporter, "test_latency", NULL, 2.0);
+	
+	body = scrape(exporter, buf, SCRAPE_SIZE);
+	ASSERT_NOT_NULL(body);
+	
+	/* One TYPE line per name however many label sets it has */
+	ASSERT_EQ(count_lines(body, "# TYPE test_events_total counter"), 1);
+	ASSERT_NOT_NULL(strstr(body, "test_events_total{type=\"1\"} 5\n"));
+	ASSERT_NOT_NULL(strstr(body, "test_events_total{type=\"2\"} 1\n"));
+	ASSERT_NOT_NULL(strstr(body, "test_gauge 2.500000\n"));
+	ASSERT_NOT_NULL(strstr(body, "test_latency_bucket{le=\"0.001\"} 0\n"));
+	ASSERT_NOT_NULL(strstr(body, "test_latency_bucket{le=\"0.005\"} 1\n"));
+	ASSERT_NOT_NULL(strstr(body, "test_latency_bucket{le=\"+Inf\"} 2\n"));
+	ASSERT_NOT_NULL(strstr(body, "test_latency_sum 2.003000\n"));
+	ASSERT_NOT_NULL(strstr(body, "test_latency_count 2\n"));
+	
+	free(buf);
+	prometheus_exporter_destroy(exporter);
+}
+
+struct inc_thread_arg {
+	struct prometheus_metric *metric;
+	int count;
+};
+
+static void *inc_thread(void *arg)
+{
+	struct inc_thread_arg *inc = arg;
+	
+	for (int i = 0; i < inc->count; i++)
+		prometheus_metric_inc(inc->metric, 1);
+	
+	return NULL;
+}
+
+TEST(prometheus_sharded_counter)
+{
+	struct prometheus_exporter *exporter = prometheus_exporter_create(0, "/metrics");
+	struct inc_thread_arg arg;
+	pthread_t threads[12];
+	char *buf = malloc(SCRAPE_SIZE);
+	char *body;
+	
+	ASSERT_NOT_NULL(exporter);
+	ASSERT_NOT_NULL(buf);
+	prometheus_exporter_set_cache_interval(exporter, 0);
+	
+	arg.metric = prometheus_exporter_register(exporter, "test_shared_total", NULL,
+	                                          METRIC_TYPE_COUNTER);
+	arg.count = 100000;
+	ASSERT_NOT_NULL(arg.metric);
+	
+	/* More threads than shards, so some share a slot */
+	for (int i = 0; i < 12; i++)
+		ASSERT_EQ(pthread_create(&threads[i], NULL, inc_thread, &arg), 0);
+	for (int i = 0; i < 12; i++)
+		pthread_join(threads[i], NULL);
+	
+	body = scrape(exporter, buf, SCRAPE_SIZE);
+	ASSERT_NOT_NULL(body);
+	ASSERT_NOT_NULL(strstr(body, "test_shared_total 1200000\n"));
+	
+	free(buf);
+	prometheus_exporter_destroy(exporter);
+}
+
+TEST(prometheus_cached_response)
+{
+	struct prometheus_exporter *exporter = prometheus_exporter_create(0, "/metrics");
+	struct prometheus_metric *metric;
+	char *buf = malloc(SCRAPE_SIZE);
+	uint64_t served;
+	char *body;
+	
+	ASSERT_NOT_NULL(exporter);
+	ASSERT_NOT_NULL(buf);
+	prometheus_exporter_set_cache_interval(exporter, 60000);
+	
+	metric = prometheus_exporter_register(exporter, "test_cached_total", NULL,
+	                                      METRIC_TYPE_COUNTER);
+	prometheus_metric_inc(metric, 1);
+	
+	body = scrape(exporter, buf, SCRAPE_SIZE);
+	ASSERT_NOT_NULL(body);
+	ASSERT_NOT_NULL(strstr(body, "test_cached_total 1\n"));
+	
+	/* Within the interval the old text is served again */
+	prometheus_metric_inc(metric, 1);
+	body = scrape(exporter, buf, SCRAPE_SIZE);
+	ASSERT_NOT_NULL(body);
+	ASSERT_NOT_NULL(strstr(body, "test_cached_total 1\n"));
+	
+	prometheus_exporter_set_cache_interval(exporter, 0);
+	body = scrape(exporter, buf, SCRAPE_SIZE);
+	ASSERT_NOT_NULL(body);
+	ASSERT_NOT_NULL(strstr(body, "test_cached_total 2\n"));
+	
+	ASSERT_TRUE(prometheus_exporter_get_stats(exporter, &served, NULL));
+	ASSERT_EQ(served, 3);
+	
+	free(buf);
+	prometheus_exporter_destroy(exporter);
+}
+
+TEST(prometheus_large_response)
+{
+	struct prometheus_exporter *exporter = prometheus_exporter_create(0, "/metrics");
+	char *buf = malloc(SCRAPE_SIZE);
+	char labels[128];
+	char *body;
+	
+	ASSERT_NOT_NULL(exporter);
+	ASSERT_NOT_NULL(buf);
+	prometheus_exporter_set_cache_interval(exporter, 0);
+	
+	/* Well over the 64 KiB the response used to be cut at */
+	for (int i = 0; i < 1000; i++) {
+		snprintf(labels, sizeof(labels), "type=\"%d\",interface=\"eth%d\",driver=\"virtio_net\"",
+		         i, i % 8);
+		prometheus_exporter_inc_counter(exporter, "test_series_total", labels, i);
+	}
+	
+	body = scrape(exporter, buf, SCRAPE_SIZE);
+	ASSERT_NOT_NULL(body);
+	ASSERT_TRUE(strlen(body) > 65536);
+	ASSERT_EQ(count_lines(body, "test_series_total{"), 1000);
+	ASSERT_NOT_NULL(strstr(body, "test_series_total{type=\"999\",interface=\"eth7\","
+	                             "driver=\"virtio_net\"} 999\n"));
+	
+	free(buf);
+	prometheus_exporter_destroy(exporter);
+}
+
+TEST(prometheus_summary_quantiles)
+{
+	struct prometheus_exporter *exporter = prometheus_exporter_create(0, "/metrics");
+	struct prometheus_metric *metric;
+	char *buf = malloc(SCRAPE_SIZE);
+	const char *line;
+	double p999;
+	char *body;
+	
+	ASSERT_NOT_NULL(exporter);
+	ASSERT_NOT_NULL(buf);
+	prometheus_exporter_set_cache_interval(exporter, 0);
+	
+	ASSERT_NULL(prometheus_exporter_register_histogram(exporter, "test_bad", NULL,
+	                                                   METRIC_TYPE_COUNTER, 3));
+	ASSERT_NULL(prometheus_exporter_register_histogram(exporter, "test_bad", NULL,
+	                                                   METRIC_TYPE_SUMMARY, 9));
+	metric = prometheus_exporter_register_histogram(exporter, "test_latency_seconds",
+	                                                "stage=\"parse\"",
+	                                                METRIC_TYPE_SUMMARY, 6);
+	ASSERT_NOT_NULL(metric);
+	
+	/* 1 ms to 10 s, the tail a fixed bucket list would smear */
+	for (int i = 1; i <= 10000; i++)
+		prometheus_metric_observe(metric, i * 0.001);
+	
+	body = scrape(exporter, buf, SCRAPE_SIZE);
+	ASSERT_NOT_NULL(body);
+	ASSERT_EQ(count_lines(body, "# TYPE test_latency_seconds summary"), 1);
+	ASSERT_NOT_NULL(strstr(body, "test_latency_seconds_count{stage=\"parse\"} 10000\n"));
+	
+	line = strstr(body, "test_latency_seconds{stage=\"parse\",quantile=\"0.999\"} ");
+	ASSERT_NOT_NULL(line);
+	p999 = strtod(strchr(line, '}') + 2, NULL);
+	ASSERT_TRUE(p999 > 9.99 * 0.99 && p999 < 9.99 * 1.01);
+	
+	free(buf);
+	prometheus_exporter_destroy(exporter);
+}
+
+TEST(prometheus_cardinality_limits)
+{
+	struct prometheus_exporter *exporter = prometheus_exporter_create(0, "/metrics");
+	struct cardinality_limits limits = { .max_series = 3, .top_k = 2 };
+	struct prometheus_metric *series[5];
+	char *buf = malloc(SCRAPE_SIZE);
+	char labels[64];
+	char *body;
+	
+	ASSERT_NOT_NULL(exporter);
+	ASSERT_NOT_NULL(buf);
+	prometheus_exporter_set_cache_interval(exporter, 0);
+	ASSERT_TRUE(prometheus_exporter_set_cardinality(exporter, "test_if_total", &limits));
+	
+	/* Label sets past max_series share the overflow series */
+	for (int i = 0; i < 5; i++) {
+		snprintf(labels, sizeof(labels), "interface=\"eth%d\"", i);
+		series[i] = prometheus_exporter_register(exporter, "test_if_total", labels,
+		                                         METRIC_TYPE_COUNTER);
+		ASSERT_NOT_NULL(series[i]);
+	}
+	ASSERT_TRUE(series[3] == series[4]);
+	ASSERT_TRUE(series[2] != series[3]);
+	
+	/* The least busy of the three is folded into the overflow series */
+	prometheus_metric_inc(series[0], 10);
+	prometheus_metric_inc(series[1], 5);
+	prometheus_metric_inc(series[2], 1);
+	prometheus_metric_inc(series[3], 7);
+	
+	body = scrape(exporter, buf, SCRAPE_SIZE);
+	ASSERT_NOT_NULL(body);
+	ASSERT_EQ(count_lines(body, "test_if_total{"), 3);
+	ASSERT_NOT_NULL(strstr(body, "test_if_total{interface=\"eth0\"} 10\n"));
+	ASSERT_NOT_NULL(strstr(body, "test_if_total{interface=\"eth1\"} 5\n"));
+	ASSERT_NOT_NULL(strstr(body, "test_if_total{" CARDINALITY_OVERFLOW_LABELS "} 8\n"));
+	ASSERT_NOT_NULL(strstr(body, "nlmon_metric_series{metric=\"test_if_total\"} 3.000000\n"));
+	ASSERT_NOT_NULL(strstr(body, "nlmon_metric_series_collapsed{metric=\"test_if_total\"} "
+	                             "2.000000\n"));
+	ASSERT_NOT_NULL(strstr(body, "nlmon_metric_series_folded{metric=\"test_if_total\"} "
+	                             "1.000000\n"));
+	
+	/* The top series are the busiest since the last scrape */
+	prometheus_metric_inc(series[2], 100);
+	body = scrape(exporter, buf, SCRAPE_SIZE);
+	ASSERT_NOT_NULL(body);
+	ASSERT_NOT_NULL(strstr(body, "test_if_total{interface=\"eth2\"} 101\n"));
+	ASSERT_NOT_NULL(strstr(body, "test_if_total{interface=\"eth0\"} 10\n"));
+	ASSERT_NOT_NULL(strstr(body, "test_if_total{" CARDINALITY_OVERFLOW_LABELS "} 12\n"));
+	
+	/* Histograms fold into an overflow series made when first needed */
+	limits = (struct cardinality_limits){ .top_k = 1 };
+	ASSERT_TRUE(prometheus_exporter_set_cardinality(exporter, "test_hist_seconds", &limits));
+	for (int i = 0; i < 3; i++)
+		prometheus_exporter_observe_histogram(exporter, "test_hist_seconds", "stage=\"a\"", 0.5);
+	prometheus_exporter_observe_histogram(exporter, "test_hist_seconds", "stage=\"b\"", 2.0);
+	
+	body = scrape(exporter, buf, SCRAPE_SIZE);
+	ASSERT_NOT_NULL(body);
+	ASSERT_NOT_NULL(strstr(body, "test_hist_seconds_count{stage=\"a\"} 3\n"));
+	ASSERT_NULL(strstr(body, "stage=\"b\""));
+	ASSERT_NOT_NULL(strstr(body, "test_hist_seconds_count{" CARDINALITY_OVERFLOW_LABELS "} 1\n"));
+	ASSERT_NOT_NULL(strstr(body, "test_hist_seconds_sum{" CARDINALITY_OVERFLOW_LABELS
+	                             "} 2.000000\n"));
+	
+	free(buf);
+	prometheus_exporter_destroy(exporter);
+}
+
+TEST(prometheus_cardinality_stale)
+{
+	struct prometheus_exporter *exporter = prometheus_exporter_create(0, "/metrics");
+	struct cardinality_limits limits = { .stale_ms = 50 };
+	char *buf = malloc(SCRAPE_SIZE);
+	char *body;
+	
+	ASSERT_NOT_NULL(exporter);
+	ASSERT_NOT_NULL(buf);
+	prometheus_exporter_set_cache_interval(exporter, 0);
+	
+	/* Default limits apply to every name */
+	ASSERT_TRUE(prometheus_exporter_set_cardinality(exporter, NULL, &limits));
+	prometheus_exporter_inc_counter(exporter, "test_stale_total", "peer=\"a\"", 1);
+	prometheus_exporter_inc_counter(exporter, "test_stale_total", "peer=\"b\"", 1);
+	
+	body = scrape(exporter, buf, SCRAPE_SIZE);
+	ASSERT_NOT_NULL(body);
+	ASSERT_EQ(count_lines(body, "test_stale_total{"), 2);
+	
+	usleep(100000);
+	prometheus_exporter_inc_counter(exporter, "test_stale_total", "peer=\"b\"", 1);
+	body = scrape(exporter, buf, SCRAPE_SIZE);
+	ASSERT_NOT_NULL(body);
+	ASSERT_EQ(count_lines(body, "test_stale_total{"), 1);
+	ASSERT_NOT_NULL(strstr(body, "test_stale_total{peer=\"b\"} 2\n"));
+	ASSERT_NOT_NULL(strstr(body, "nlmon_metric_series_expired{metric=\"test_stale_total\"} "
+	                             "1.000000\n"));
+	
+	/* A series that moves again is back */
+	prometheus_exporter_inc_counter(exporter, "test_stale_total", "peer=\"a\"", 1);
+	body = scrape(exporter, buf, SCRAPE_SIZE);
+	ASSERT_NOT_NULL(body);
+	ASSERT_EQ(count_lines(body, "test_stale_total{"), 2);
+	
+	free(buf);
+	prometheus_exporter_destroy(exporter);
+}
+
+/* Protobuf reader for the test, one field at a time */
+struct pb_field {
+	unsigned int number;
+	unsigned int wire;
+	uint64_t value;                 /* Varint or fixed64 */
+	const unsigned char *data;      /* Length delimited */
+	size_t len;
+};
+
+static bool pb_read_varint(const unsigned char **p, const unsigned char *end, uint64_t *value)
+{
+	int shift = 0;
+	
+	*value = 0;
+	while (*p < end && shift < 64) {
+		unsigned char byte = *(*p)++;
+		
+		*value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return true;
+		shift += 7;
+	}
+	
+	return false;
+}
+
+static bool pb_next(const unsigned char **p, const unsigned char *end, struct pb_field *f)
+{
+	uint64_t key;
+	
+	if (*p >= end || !pb_read_varint(p, end, &key))
+		return false;
+	
+	f->number = (unsigned int)(key >> 3);
+	f->wire = (unsigned int)(key & 7);
+	
+	switch (f->wire) {
+	case 0:
+		return pb_read_varint(p, end, &f->value);
+	case 1:
+		if (end - *p < 8)
+			return false;
+		memcpy(&f->value, *p, 8);
+		*p += 8;
+		return true;
+	case 2:
+		if (!pb_read_varint(p, end, &f->value) || (uint64_t)(end - *p) < f->value)
+			return false;
+		f->data = *p;
+		f->len = (size_t)f->value;
+		*p += f->len;
+		return true;
+	default:
+		return false;
+	}
+}
+
+TEST(prometheus_native_histogram)
+{
+	struct prometheus_exporter *exporter = prometheus_exporter_create(0, "/metrics");
+	const unsigned char *p, *end;
+	char *buf = malloc(SCRAPE_SIZE);
+	bool found = false;
+	size_t len;
+	char *body;
+	
+	ASSERT_NOT_NULL(exporter);
+	ASSERT_NOT_NULL(buf);
+	prometheus_exporter_set_cache_interval(exporter, 0);
+	
+	prometheus_exporter_inc_counter(exporter, "test_total", "type=\"1\"", 7);
+	prometheus_exporter_observe_histogram(exporter, "test_hist", NULL, 1.0);
+	prometheus_exporter_observe_histogram(exporter, "test_hist", NULL, 1.0);
+	prometheus_exporter_observe_histogram(exporter, "test_hist", NULL, 4.0);
+	prometheus_exporter_observe_histogram(exporter, "test_hist", NULL, 0.0);
+	
+	body = scrape_accept(exporter, buf, SCRAPE_SIZE,
+	                     "application/vnd.google.protobuf;proto=io.prometheus.client.MetricFamily;"
+	                     "encoding=delimited", &len);
+	ASSERT_NOT_NULL(body);
+	ASSERT_NOT_NULL(strstr(buf, "Content-Type: application/vnd.google.protobuf"));
+	
+	p = (const unsigned char *)body;
+	end = p + len;
+	while (p < end) {
+		const unsigned char *fp, *fend;
+		struct pb_field f;
+		uint64_t family_len;
+		bool histogram = false;
+		
+		ASSERT_TRUE(pb_read_varint(&p, end, &family_len));
+		ASSERT_TRUE((uint64_t)(end - p) >= family_len);
+		fp = p;
+		fend = p + family_len;
+		p = fend;
+		
+		while (pb_next(&fp, fend, &f)) {
+			if (f.number == 1)
+				histogram = f.len == 9 && memcmp(f.data, "test_hist", 9) == 0;
+			if (f.number == 3 && histogram)
+				ASSERT_EQ(f.value, 4);
+			if (f.number == 4 && histogram) {
+				const unsigned char *mp = f.data, *mend = f.data + f.len;
+				struct pb_field m;
+				
+				while (pb_next(&mp, mend, &m)) {
+					const unsigned char *hp = m.data, *hend = m.data + m.len;
+					struct pb_field h;
+					int spans = 0, deltas = 0;
+					int64_t delta_sum = 0, running = 0;
+					
+					if (m.number != 7)
+						continue;
+					
+					while (pb_next(&hp, hend, &h)) {
+						int64_t signed_value = (int64_t)(h.value >> 1) ^ -(int64_t)(h.value & 1);
+						
+						if (h.number == 1)
+							ASSERT_EQ(h.value, 4);
+						if (h.number == 5)
+							ASSERT_EQ(signed_value, HDR_HISTOGRAM_DEFAULT_SCHEMA);
+						if (h.number == 7)
+							ASSERT_EQ(h.value, 1);
+						if (h.number == 12)
+							spans++;
+						if (h.number == 13) {
+							running += signed_value;
+							delta_sum += running;
+							deltas++;
+						}
+					}
+					
+					/* Buckets 0 and 16 at schema 3, two spans of one */
+					ASSERT_EQ(spans, 2);
+					ASSERT_EQ(deltas, 2);
+					ASSERT_EQ(delta_sum, 3);
+					found = true;
+				}
+			}
+		}
+	}
+	ASSERT_TRUE(found);
+	
+	/* Text scrapes still get the fixed buckets */
+	body = scrape(exporter, buf, SCRAPE_SIZE);
+	ASSERT_NOT_NULL(body);
+	ASSERT_NOT_NULL(strstr(body, "test_hist_bucket{le=\"1.000\"} 3\n"));
+	
+	free(buf);
+	prometheus_exporter_destroy(exporter);
+}
+
+TEST(prometheus_keep_alive)
+{
+	struct prometheus_exporter *exporter = prometheus_exporter_create(0, "/metrics");
+	const char *get = "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+	char *buf = malloc(SCRAPE_SIZE);
+	uint64_t served;
+	char *body;
+	int sock;
+	
+	ASSERT_NOT_NULL(exporter);
+	ASSERT_NOT_NULL(buf);
+	prometheus_exporter_inc_counter(exporter, "test_alive_total", NULL, 1);
+	
+	sock = connect_exporter(exporter);
+	ASSERT_TRUE(sock >= 0);
+	
+	/* Several requests on one HTTP/1.1 connection */
+	for (int i = 0; i < 3; i++) {
+		ASSERT_EQ(send(sock, get, strlen(get), 0), (ssize_t)strlen(get));
+		ASSERT_TRUE(read_response(sock, buf, SCRAPE_SIZE, &body) > 0);
+		ASSERT_EQ(strncmp(buf, "HTTP/1.1 200 OK", 15), 0);
+		ASSERT_NOT_NULL(strstr(buf, "Connection: keep-alive\r\n"));
+		ASSERT_NOT_NULL(strstr(body, "test_alive_total 1\n"));
+	}
+	
+	/* Errors keep the connection open too */
+	get = "GET /other HTTP/1.1\r\n\r\n";
+	ASSERT_EQ(send(sock, get, strlen(get), 0), (ssize_t)strlen(get));
+	ASSERT_EQ(read_response(sock, buf, SCRAPE_SIZE, &body), 0);
+	ASSERT_EQ(strncmp(buf, "HTTP/1.1 404 Not Found", 22), 0);
+	
+	get = "POST /metrics HTTP/1.1\r\n\r\n";
+	ASSERT_EQ(send(sock, get, strlen(get), 0), (ssize_t)strlen(get));
+	ASSERT_EQ(read_response(sock, buf, SCRAPE_SIZE, &body), 0);
+	ASSERT_EQ(strncmp(buf, "HTTP/1.1 405", 12), 0);
+	
+	/* HTTP/1.0 closes unless asked not to */
+	get = "GET /metrics HTTP/1.0\r\n\r\n";
+	ASSERT_EQ(send(sock, get, strlen(get), 0), (ssize_t)strlen(get));
+	ASSERT_TRUE(read_response(sock, buf, SCRAPE_SIZE, &body) > 0);
+	ASSERT_NOT_NULL(strstr(buf, "Connection: close\r\n"));
+	ASSERT_EQ(recv(sock, buf, SCRAPE_SIZE, 0), 0);
+	close(sock);
+	
+	ASSERT_TRUE(prometheus_exporter_get_stats(exporter, &served, NULL));
+	ASSERT_EQ(served, 4);
+	
+	free(buf);
+	prometheus_exporter_destroy(exporter);
+}
+
+TEST(prometheus_gzip_response)
+{
+	struct prometheus_exporter *exporter = prometheus_exporter_create(0, "/metrics");
+	const char *get = "GET /metrics HTTP/1.1\r\nAccept-Encoding: deflate, GZIP\r\n\r\n";
+	char *buf = malloc(SCRAPE_SIZE);
+	char *plain = malloc(SCRAPE_SIZE);
+	char *inflated = malloc(SCRAPE_SIZE);
+	char labels[128];
+	ssize_t len;
+	z_stream zs;
+	char *body;
+	int sock;
+	
+	ASSERT_NOT_NULL(exporter);
+	ASSERT_NOT_NULL(buf);
+	ASSERT_NOT_NULL(plain);
+	ASSERT_NOT_NULL(inflated);
+	prometheus_exporter_set_cache_interval(exporter, 60000);
+	
+	for (int i = 0; i < 200; i++) {
+		snprintf(labels, sizeof(labels), "type=\"%d\"", i);
+		prometheus_exporter_inc_counter(exporter, "test_gzip_total", labels, i);
+	}
+	
+	body = scrape(exporter, plain, SCRAPE_SIZE);
+	ASSERT_NOT_NULL(body);
+	
+	sock = connect_exporter(exporter);
+	ASSERT_TRUE(sock >= 0);
+	ASSERT_EQ(send(sock, get, strlen(get), 0), (ssize_t)strlen(get));
+	len = read_response(sock, buf, SCRAPE_SIZE, &body);
+	close(sock);
+	
+	ASSERT_TRUE(len > 0);
+	ASSERT_NOT_NULL(strstr(buf, "Content-Encoding: gzip\r\n"));
+	ASSERT_TRUE((size_t)len < strlen(strstr(plain, "\r\n\r\n") + 4));
+	
+	memset(&zs, 0, sizeof(zs));
+	ASSERT_EQ(inflateInit2(&zs, 15 + 16), Z_OK);
+	zs.next_in = (Bytef *)body;
+	zs.avail_in = (uInt)len;
+	zs.next_out = (Bytef *)inflated;
+	zs.avail_out = SCRAPE_SIZE - 1;
+	ASSERT_EQ(inflate(&zs, Z_FINISH), Z_STREAM_END);
+	inflated[zs.total_out] = '\0';
+	inflateEnd(&zs);
+	
+	/* Same cached body as the plain scrape */
+	ASSERT_STR_EQ(inflated, strstr(plain, "\r\n\r\n") + 4);
+	
+	free(inflated);
+	free(plain);
+	free(buf);
+	prometheus_exporter_destroy(exporter);
+}
+
+TEST(prometheus_concurrent_scrapes)
+{
+	struct prometheus_exporter *exporter = prometheus_exporter_create(0, "/metrics");
+	const char *get = "GET /metrics HTTP/1.1\r\n\r\n";
+	struct timeval timeout = { .tv_sec = 5 };
+	char *buf = malloc(SCRAPE_SIZE);
+	char labels[128];
+	int slow, i;
+	char *body;
+	
+	ASSERT_NOT_NULL(exporter);
+	ASSERT_NOT_NULL(buf);
+	
+	for (i = 0; i < 1000; i++) {
+		snprintf(labels, sizeof(labels), "type=\"%d\",interface=\"eth%d\"", i, i % 8);
+		prometheus_exporter_inc_counter(exporter, "test_slow_total", labels, i);
+	}
+	
+	/* A scraper that asks for many responses and never reads them */
+	slow = connect_exporter(exporter);
+	ASSERT_TRUE(slow >= 0);
+	for (i = 0; i < 200; i++)
+		ASSERT_EQ(send(slow, get, strlen(get), 0), (ssize_t)strlen(get));
+	usleep(100000);
+	
+	/* Other scrapes are still answered */
+	for (i = 0; i < 3; i++) {
+		int sock = connect_exporter(exporter);
+		
+		ASSERT_TRUE(sock >= 0);
+		setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		ASSERT_EQ(send(sock, get, strlen(get), 0), (ssize_t)strlen(get));
+		ASSERT_TRUE(read_response(sock, buf, SCRAPE_SIZE, &body) > 0);
+		ASSERT_EQ(count_lines(body, "test_slow_total{"), 1000);
+		close(sock);
+	}
+	
+	close(slow);
+	free(buf);
+	prometheus_exporter_destroy(exporter);
+}
+
+TEST_SUITE_BEGIN("Prometheus Exporter")
+	RUN_TEST(prometheus_register_handles);
+	RUN_TEST(prometheus_sharded_counter);
+	RUN_TEST(prometheus_cached_response);
+	RUN_TEST(prometheus_large_response);
+	RUN_TEST(prometheus_summary_quantiles);
+	RUN_TEST(prometheus_cardinality_limits);
+	RUN_TEST(prometheus_cardinality_stale);
+	RUN_TEST(prometheus_native_histogram);
+	RUN_TEST(prometheus_keep_alive);
+	RUN_TEST(prometheus_gzip_response);
+	RUN_TEST(prometheus_concurrent_scrapes);
+TEST_SUITE_END()
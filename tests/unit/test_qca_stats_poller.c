@@ -0,0 +1,169 @@
+/* test_qca_stats_poller.c - Unit tests for link stats deltas */
+
+#include "test_framework.h"
+#include "qca_nlmon_integration.h"
+#include "event_processor.h"
+#include <stdio.h>
+#include <string.h>
+#include <linux/netlink.h>
+
+/* Reports of the last sink call */
+static int sink_calls;
+static char sink_interface[16];
+static uint32_t sink_type;
+static size_t sink_count;
+static struct qca_stats_counter sink_counters[QCA_STATS_MAX_COUNTERS];
+
+static void record_sink(struct nlmon_event *event, void *user_data)
+{
+	(void)user_data;
+	sink_calls++;
+	snprintf(sink_interface, sizeof(sink_interface), "%s", event->interface);
+	sink_type = event->event_type;
+	sink_count = event->data_size / sizeof(sink_counters[0]);
+	memcpy(sink_counters, event->data, event->data_size);
+}
+
+static size_t put_attr(uint8_t *buf, size_t off, uint16_t type, const void *data, size_t len)
+{
+	struct nlattr *nla = (struct nlattr *)(buf + off);
+	
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + len;
+	memcpy(buf + off + NLA_HDRLEN, data, len);
+	return off + NLA_ALIGN(nla->nla_len);
+}
+
+/*
+ * Counters 1 (u32) and 2 (u64), a MAC address, 3 nesting counters 1 and 2,
+ * and 5 flagged as nesting counter 1 alone
+ */
+static size_t make_sample(uint8_t *buf, uint32_t a, uint64_t b, uint32_t nested)
+{
+	static const uint8_t mac[6] = { 0x02, 0, 0, 0, 0, 1 };
+	uint32_t zero = 0;
+	uint8_t inner[16];
+	size_t off = 0, inner_len;
+	
+	off = put_attr(buf, off, 1, &a, sizeof(a));
+	off = put_attr(buf, off, 2, &b, sizeof(b));
+	off = put_attr(buf, off, 4, mac, sizeof(mac));
+	inner_len = put_attr(inner, 0, 1, &nested, sizeof(nested));
+	inner_len = put_attr(inner, inner_len, 2, &zero, sizeof(zero));
+	off = put_attr(buf, off, 3, inner, inner_len);
+	inner_len = put_attr(inner, 0, 1, &nested, sizeof(nested));
+	return put_attr(buf, off, 5 | NLA_F_NESTED, inner, inner_len);
+}
+
+static const struct qca_stats_counter *find_counter(const char *path)
+{
+	char key[32];
+	
+	for (size_t i = 0; i < sink_count; i++) {
+		qca_stats_key_format(sink_counters[i].key, key, sizeof(key));
+		if (strcmp(key, path) == 0)
+			return &sink_counters[i];
+	}
+	return NULL;
+}
+
+TEST(qca_stats_poller_deltas)
+{
+	const char *ifnames[] = { "wlan0", "wlan1" };
+	struct qca_stats_poller_config config = {
+		.ifnames = ifnames,
+		.count = 2,
+		.interval_ms = 1000,
+		.sink = record_sink,
+	};
+	struct qca_stats_poller *poller = qca_stats_poller_create(&config);
+	const struct qca_stats_counter *counter;
+	uint8_t buf[128];
+	size_t len;
+	
+	ASSERT_NOT_NULL(poller);
+	sink_calls = 0;
+	
+	/* The first sample is the baseline */
+	len = make_sample(buf, 100, 1000, 5);
+	ASSERT_EQ(qca_stats_poller_update(poller, "wlan0", 0, buf, len), 0);
+	ASSERT_EQ(sink_calls, 0);
+	
+	/* Only changed counters are reported, the address is none */
+	len = make_sample(buf, 100, 1500, 7);
+	ASSERT_EQ(qca_stats_poller_update(poller, "wlan0", 0, buf, len), 3);
+	ASSERT_EQ(sink_calls, 1);
+	ASSERT_STR_EQ(sink_interface, "wlan0");
+	ASSERT_EQ(sink_type, QCA_NLMON_EVENT_LINK_STATS);
+	ASSERT_EQ(sink_count, 3);
+	counter = find_counter("0:2");
+	ASSERT_NOT_NULL(counter);
+	ASSERT_EQ(counter->value, 1500);
+	ASSERT_EQ(counter->delta, 500);
+	counter = find_counter("0:3.1");
+	ASSERT_NOT_NULL(counter);
+	ASSERT_EQ(counter->delta, 2);
+	counter = find_counter("0:5.1");
+	ASSERT_NOT_NULL(counter);
+	ASSERT_EQ(counter->delta, 2);
+	
+	/* Unchanged samples report nothing */
+	ASSERT_EQ(qca_stats_poller_update(poller, "wlan0", 0, buf, len), 0);
+	ASSERT_EQ(sink_calls, 1);
+	
+	/* A 32-bit counter counts on over its wrap */
+	len = make_sample(buf, 0xfffffff0, 1500, 7);
+	ASSERT_EQ(qca_stats_poller_update(poller, "wlan0", 0, buf, len), 1);
+	len = make_sample(buf, 0x10, 1500, 7);
+	ASSERT_EQ(qca_stats_poller_update(poller, "wlan0", 0, buf, len), 1);
+	ASSERT_EQ(sink_counters[0].delta, 0x20);
+	
+	/* Other replies and interfaces keep their own counters */
+	ASSERT_EQ(qca_stats_poller_update(poller, "wlan0", 1, buf, len), 0);
+	ASSERT_EQ(qca_stats_poller_update(poller, "wlan1", 0, buf, len), 0);
+	ASSERT_EQ(qca_stats_poller_update(poller, "wlan2", 0, buf, len), -1);
+	
+	/* A reset starts new baselines */
+	qca_stats_poller_reset(poller);
+	len = make_sample(buf, 1, 2, 3);
+	ASSERT_EQ(qca_stats_poller_update(poller, "wlan0", 0, buf, len), 0);
+	
+	qca_stats_poller_destroy(poller);
+}
+
+TEST(qca_stats_poller_jitter)
+{
+	const char *ifname = "wlan0";
+	struct qca_stats_poller_config config = {
+		.ifnames = &ifname,
+		.count = 1,
+		.interval_ms = 1000,
+		.jitter_pct = 10,
+	};
+	struct qca_stats_poller *poller = qca_stats_poller_create(&config);
+	unsigned int lo = ~0U, hi = 0;
+	
+	ASSERT_NOT_NULL(poller);
+	for (int i = 0; i < 1000; i++) {
+		unsigned int ms = qca_stats_poller_next_ms(poller);
+	
+		lo = ms < lo ? ms : lo;
+		hi = ms > hi ? ms : hi;
+	}
+	ASSERT_TRUE(lo >= 900);
+	ASSERT_TRUE(hi <= 1100);
+	ASSERT_TRUE(lo < hi);
+	qca_stats_poller_destroy(poller);
+	
+	/* Too much jitter or too many interfaces */
+	config.jitter_pct = 60;
+	ASSERT_NULL(qca_stats_poller_create(&config));
+	config.jitter_pct = 0;
+	config.count = QCA_STATS_MAX_INTERFACES + 1;
+	ASSERT_NULL(qca_stats_poller_create(&config));
+}
+
+TEST_SUITE_BEGIN("QCA Stats Poller")
+	RUN_TEST(qca_stats_poller_deltas);
+	RUN_TEST(qca_stats_poller_jitter);
+TEST_SUITE_END()
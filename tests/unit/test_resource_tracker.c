@@ -0,0 +1,194 @@
+/* test_resource_tracker.c - Unit tests for metric handles and sharded counters */
+
+#include "test_framework.h"
+#include "resource_tracker.h"
+#include <pthread.h>
+#include <string.h>
+
+#define UPDATE_THREADS 8
+#define UPDATES_PER_THREAD 100000
+
+struct update_arg {
+	struct resource_tracker *tracker;
+	int counter;
+	int gauge;
+};
+
+static void *update_thread(void *data)
+{
+	struct update_arg *arg = data;
+	
+	for (int i = 0; i < UPDATES_PER_THREAD; i++) {
+		resource_tracker_counter_add(arg->tracker, arg->counter, 1);
+		resource_tracker_gauge_update(arg->tracker, arg->gauge, i);
+	}
+	/* Name lookups land in the same shards */
+	resource_tracker_counter_inc(arg->tracker, "events_total", "type=link", 10);
+	return NULL;
+}
+
+TEST(tracker_handles)
+{
+	struct resource_tracker *tracker = resource_tracker_create(4);
+	union metric_value value;
+	enum metric_type type;
+	int counter, gauge, histogram;
+	
+	ASSERT_NOT_NULL(tracker);
+	
+	counter = resource_tracker_register(tracker, "events_total", "type=link", METRIC_COUNTER);
+	gauge = resource_tracker_register(tracker, "queue_depth", NULL, METRIC_GAUGE);
+	histogram = resource_tracker_register(tracker, "latency", NULL, METRIC_HISTOGRAM);
+	ASSERT_TRUE(counter >= 0 && gauge >= 0 && histogram >= 0);
+	ASSERT_NE(counter, gauge);
+	
+	/* Same name and labels, same handle; NULL labels match "" */
+	ASSERT_EQ(resource_tracker_register(tracker, "events_total", "type=link", METRIC_COUNTER),
+	          counter);
+	ASSERT_EQ(resource_tracker_register(tracker, "queue_depth", "", METRIC_GAUGE), gauge);
+	ASSERT_EQ(resource_tracker_register(tracker, "queue_depth", NULL, METRIC_COUNTER), -1);
+	
+	ASSERT_TRUE(resource_tracker_counter_add(tracker, counter, 5));
+	ASSERT_TRUE(resource_tracker_counter_inc(tracker, "events_total", "type=link", 2));
+	ASSERT_FALSE(resource_tracker_counter_add(tracker, gauge, 1));
+	ASSERT_FALSE(resource_tracker_counter_add(tracker, 3, 1));
+	ASSERT_FALSE(resource_tracker_counter_add(tracker, -1, 1));
+	ASSERT_TRUE(resource_tracker_gauge_update(tracker, gauge, 2.5));
+	ASSERT_TRUE(resource_tracker_histogram_record(tracker, histogram, 0.02));
+	ASSERT_FALSE(resource_tracker_gauge_set(tracker, "events_total", "type=link", 1.0));
+	
+	ASSERT_TRUE(resource_tracker_get_metric(tracker, "events_total", "type=link", &type, &value));
+	ASSERT_EQ(type, METRIC_COUNTER);
+	ASSERT_EQ(value.counter, 7);
+	ASSERT_TRUE(resource_tracker_get_metric(tracker, "queue_depth", NULL, NULL, &value));
+	ASSERT_TRUE(value.gauge == 2.5);
+	ASSERT_TRUE(resource_tracker_get_metric(tracker, "latency", NULL, NULL, &value));
+	ASSERT_EQ(value.histogram.count, 1);
+	ASSERT_EQ(value.histogram.buckets[3], 1);
+	ASSERT_FALSE(resource_tracker_get_metric(tracker, "events_total", NULL, NULL, &value));
+	
+	ASSERT_TRUE(resource_tracker_reset_metric(tracker, "events_total", "type=link"));
+	ASSERT_TRUE(resource_tracker_get_metric(tracker, "events_total", "type=link", NULL, &value));
+	ASSERT_EQ(value.counter, 0);
+	
+	/* Full: one slot left, then none */
+	ASSERT_TRUE(resource_tracker_register(tracker, "last", NULL, METRIC_COUNTER) >= 0);
+	ASSERT_EQ(resource_tracker_register(tracker, "extra", NULL, METRIC_COUNTER), -1);
+	ASSERT_FALSE(resource_tracker_counter_inc(tracker, "extra", NULL, 1));
+	
+	/* Refreshing system gauges registers them without deadlocking */
+	resource_tracker_destroy(tracker);
+	tracker = resource_tracker_create(0);
+	ASSERT_NOT_NULL(tracker);
+	resource_tracker_update_system_metrics(tracker);
+	ASSERT_TRUE(resource_tracker_get_metric(tracker, "nlmon_memory_rss_bytes", NULL, NULL, &value));
+	ASSERT_TRUE(value.gauge > 0);
+	resource_tracker_destroy(tracker);
+}
+
+TEST(tracker_concurrent_updates)
+{
+	struct resource_tracker *tracker = resource_tracker_create(0);
+	pthread_t threads[UPDATE_THREADS];
+	struct update_arg arg;
+	union metric_value value;
+	static char buffer[4096];
+	char expected[64];
+	
+	ASSERT_NOT_NULL(tracker);
+	
+	arg.tracker = tracker;
+	arg.counter = resource_tracker_register(tracker, "events_total", "type=link", METRIC_COUNTER);
+	arg.gauge = resource_tracker_register(tracker, "queue_depth", NULL, METRIC_GAUGE);
+	ASSERT_TRUE(arg.counter >= 0 && arg.gauge >= 0);
+	
+	for (int i = 0; i < UPDATE_THREADS; i++)
+		ASSERT_EQ(pthread_create(&threads[i], NULL, update_thread, &arg), 0);
+	for (int i = 0; i < UPDATE_THREADS; i++)
+		pthread_join(threads[i], NULL);
+	
+	ASSERT_TRUE(resource_tracker_get_metric(tracker, "events_total", "type=link", NULL, &value));
+	ASSERT_EQ(value.counter, (uint64_t)UPDATE_THREADS * (UPDATES_PER_THREAD + 10));
+	ASSERT_TRUE(resource_tracker_get_metric(tracker, "queue_depth", NULL, NULL, &value));
+	ASSERT_TRUE(value.gauge == UPDATES_PER_THREAD - 1);
+	
+	/* Export sums the shards too */
+	ASSERT_TRUE(resource_tracker_export_prometheus(tracker, buffer, sizeof(buffer)) > 0);
+	snprintf(expected, sizeof(expected), "events_total{type=link} %d\n",
+	         UPDATE_THREADS * (UPDATES_PER_THREAD + 10));
+	ASSERT_NOT_NULL(strstr(buffer, expected));
+	
+	resource_tracker_destroy(tracker);
+}
+
+struct list_arg {
+	int series;
+	uint64_t overflow;
+};
+
+static void list_series(const struct metric *m, void *data)
+{
+	struct list_arg *arg = data;
+	
+	if (strcmp(m->name, "flows_total") != 0)
+		return;
+	arg->series++;
+	if (strcmp(m->labels, CARDINALITY_OVERFLOW_LABELS) == 0)
+		arg->overflow = m->value.counter;
+}
+
+TEST(tracker_cardinality)
+{
+	struct resource_tracker *tracker = resource_tracker_create(0);
+	struct cardinality_limits limits = { .max_series = 3, .top_k = 2 };
+	struct list_arg arg = { 0 };
+	static char buffer[8192];
+	char labels[32];
+	int handles[4];
+	
+	ASSERT_NOT_NULL(tracker);
+	ASSERT_TRUE(resource_tracker_set_cardinality(tracker, "flows_total", &limits));
+	
+	/* The fourth peer collapses into the overflow series */
+	for (int i = 0; i < 4; i++) {
+		snprintf(labels, sizeof(labels), "peer=\"%d\"", i);
+		handles[i] = resource_tracker_register(tracker, "flows_total", labels, METRIC_COUNTER);
+		ASSERT_TRUE(handles[i] >= 0);
+	}
+	ASSERT_EQ(resource_tracker_register(tracker, "flows_total", "peer=\"9\"", METRIC_COUNTER),
+	          handles[3]);
+	
+	resource_tracker_counter_add(tracker, handles[0], 1);
+	resource_tracker_counter_add(tracker, handles[1], 20);
+	resource_tracker_counter_add(tracker, handles[2], 30);
+	resource_tracker_counter_add(tracker, handles[3], 4);
+	
+	/* Peer 0, the least busy, is folded in */
+	resource_tracker_list_metrics(tracker, list_series, &arg);
+	ASSERT_EQ(arg.series, 3);
+	ASSERT_EQ(arg.overflow, 5);
+	
+	/* Then peer 2, idle since, while ties go to the first registered */
+	resource_tracker_counter_add(tracker, handles[0], 100);
+	ASSERT_TRUE(resource_tracker_export_prometheus(tracker, buffer, sizeof(buffer)) > 0);
+	ASSERT_NOT_NULL(strstr(buffer, "flows_total{peer=\"0\"} 101\n"));
+	ASSERT_NOT_NULL(strstr(buffer, "flows_total{" CARDINALITY_OVERFLOW_LABELS "} 34\n"));
+	ASSERT_NOT_NULL(strstr(buffer, "nlmon_metric_series_collapsed{metric=\"flows_total\"} "
+	                               "2.000000\n"));
+	
+	/* Lifting the limits shows every series again */
+	limits = (struct cardinality_limits){ 0 };
+	ASSERT_TRUE(resource_tracker_set_cardinality(tracker, "flows_total", &limits));
+	memset(&arg, 0, sizeof(arg));
+	resource_tracker_list_metrics(tracker, list_series, &arg);
+	ASSERT_EQ(arg.series, 4);
+	ASSERT_EQ(arg.overflow, 4);
+	
+	resource_tracker_destroy(tracker);
+}
+
+TEST_SUITE_BEGIN("Resource Tracker")
+	RUN_TEST(tracker_handles);
+	RUN_TEST(tracker_concurrent_updates);
+	RUN_TEST(tracker_cardinality);
+TEST_SUITE_END()
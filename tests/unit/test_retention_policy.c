@@ -0,0 +1,171 @@
+/* test_retention_policy.c - Unit tests for retention admission and accounting */
+
+#include "test_framework.h"
+#include "retention_policy.h"
+#include "storage_db.h"
+#include "event_processor.h"
+#include "nlmon_clock.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_DB_PATH "/tmp/test_unit_retention_policy.db"
+
+static struct storage_db *open_test_db(void)
+{
+	struct storage_db_config config = { .db_path = TEST_DB_PATH };
+	
+	unlink(TEST_DB_PATH);
+	return storage_db_open(&config);
+}
+
+static void close_test_db(struct storage_db *db)
+{
+	storage_db_close(db);
+	unlink(TEST_DB_PATH);
+}
+
+/* Store and account events at timestamps [first, first + count) */
+static void store_events(struct storage_db *db, struct retention_policy *policy,
+                         uint64_t first, int count)
+{
+	for (int i = 0; i < count; i++) {
+		struct nlmon_event event = {0};
+		
+		event.timestamp = first + i;
+		storage_db_insert(db, &event);
+		retention_policy_account(policy, event.timestamp, 100);
+	}
+	storage_db_flush(db);
+}
+
+TEST(retention_admission)
+{
+	struct retention_policy_config config = { .max_age_seconds = 100 };
+	struct retention_policy *policy;
+	struct retention_stats stats;
+	uint64_t now = (uint64_t)nlmon_clock_seconds();
+	
+	policy = retention_policy_create(&config, NULL, NULL);
+	ASSERT_NOT_NULL(policy);
+	
+	ASSERT_TRUE(retention_policy_check_event(policy, now));
+	ASSERT_TRUE(retention_policy_check_event(policy, now - 50));
+	ASSERT_FALSE(retention_policy_check_event(policy, now - 200));
+	
+	ASSERT_TRUE(retention_policy_get_stats(policy, &stats));
+	ASSERT_EQ(stats.rejected, 1);
+	ASSERT_TRUE(stats.admit_from >= now - 100 && stats.admit_from <= now - 99);
+	
+	/* A new maximum age applies at once */
+	config.max_age_seconds = 300;
+	ASSERT_TRUE(retention_policy_update_config(policy, &config));
+	ASSERT_TRUE(retention_policy_check_event(policy, now - 200));
+	
+	retention_policy_destroy(policy);
+}
+
+TEST(retention_max_events)
+{
+	struct retention_policy_config config = { .max_events = 500, .bucket_seconds = 10 };
+	struct retention_policy *policy;
+	struct retention_stats stats;
+	struct storage_db *db;
+	uint64_t total;
+	
+	db = open_test_db();
+	ASSERT_NOT_NULL(db);
+	policy = retention_policy_create(&config, db, NULL);
+	ASSERT_NOT_NULL(policy);
+	
+	/* 200 slices of 10 events, more than the ring holds */
+	store_events(db, policy, 0, 2000);
+	ASSERT_TRUE(retention_policy_get_stats(policy, &stats));
+	ASSERT_EQ(stats.current_event_count, 2000);
+	
+	/* Exactly the oldest slices over the limit go */
+	ASSERT_EQ(retention_policy_enforce(policy), 1500);
+	ASSERT_TRUE(storage_db_get_stats(db, &total, NULL, NULL));
+	ASSERT_EQ(total, 500);
+	ASSERT_TRUE(retention_policy_get_stats(policy, &stats));
+	ASSERT_EQ(stats.current_event_count, 500);
+	
+	/* Within the limit nothing more goes */
+	ASSERT_EQ(retention_policy_enforce(policy), 0);
+	
+	/* Late events of the dropped slices are turned away */
+	ASSERT_FALSE(retention_policy_check_event(policy, 1200));
+	ASSERT_TRUE(retention_policy_check_event(policy, 1500));
+	
+	retention_policy_destroy(policy);
+	close_test_db(db);
+}
+
+TEST(retention_max_age)
+{
+	struct retention_policy_config config = { .max_age_seconds = 500, .bucket_seconds = 10 };
+	struct retention_policy *policy;
+	struct retention_stats stats;
+	struct storage_db *db;
+	uint64_t now = (uint64_t)nlmon_clock_seconds();
+	uint64_t total;
+	int deleted;
+	
+	db = open_test_db();
+	ASSERT_NOT_NULL(db);
+	policy = retention_policy_create(&config, db, NULL);
+	ASSERT_NOT_NULL(policy);
+	
+	store_events(db, policy, now - 1000, 1000);
+	deleted = retention_policy_enforce(policy);
+	ASSERT_TRUE(deleted >= 500 && deleted <= 502);
+	
+	/* The accounting follows the rows the cutoff took */
+	ASSERT_TRUE(storage_db_get_stats(db, &total, NULL, NULL));
+	ASSERT_TRUE(retention_policy_get_stats(policy, &stats));
+	ASSERT_EQ(stats.current_event_count, total);
+	
+	retention_policy_destroy(policy);
+	close_test_db(db);
+}
+
+TEST(retention_existing_events)
+{
+	struct retention_policy_config config = { .max_events = 300, .bucket_seconds = 10 };
+	struct retention_policy *policy;
+	struct retention_stats stats;
+	struct storage_db *db;
+	uint64_t total;
+	
+	db = open_test_db();
+	ASSERT_NOT_NULL(db);
+	for (int i = 0; i < 1000; i++) {
+		struct nlmon_event event = {0};
+		
+		event.timestamp = i;
+		storage_db_insert(db, &event);
+	}
+	storage_db_flush(db);
+	
+	/* Stored before the policy, counted once and cut oldest first */
+	policy = retention_policy_create(&config, db, NULL);
+	ASSERT_NOT_NULL(policy);
+	ASSERT_TRUE(retention_policy_get_stats(policy, &stats));
+	ASSERT_EQ(stats.current_event_count, 1000);
+	
+	ASSERT_EQ(retention_policy_enforce(policy), 700);
+	ASSERT_TRUE(storage_db_get_stats(db, &total, NULL, NULL));
+	ASSERT_EQ(total, 300);
+	ASSERT_TRUE(retention_policy_get_stats(policy, &stats));
+	ASSERT_EQ(stats.current_event_count, 300);
+	
+	retention_policy_destroy(policy);
+	close_test_db(db);
+}
+
+TEST_SUITE_BEGIN("Retention Policy")
+	RUN_TEST(retention_admission);
+	RUN_TEST(retention_max_events);
+	RUN_TEST(retention_max_age);
+	RUN_TEST(retention_existing_events);
+TEST_SUITE_END()
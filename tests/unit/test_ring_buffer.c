@@ -4,6 +4,7 @@
 #include "ring_buffer.h"
 #include <pthread.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 
 TEST(ring_buffer_create_destroy)
 {
@@ -139,6 +140,44 @@ TEST(ring_buffer_stats)
 	ring_buffer_destroy(rb);
 }
 
+TEST(ring_buffer_dequeue_bulk)
+{
+	struct ring_buffer *rb = ring_buffer_create(8);
+	ASSERT_NOT_NULL(rb);
+	
+	int values[10];
+	void *items[16];
+	unsigned long enqueued, dequeued, overflows, peak;
+	
+	for (int i = 0; i < 10; i++)
+		values[i] = i;
+	
+	/* Partial batch */
+	for (int i = 0; i < 6; i++)
+		ASSERT_TRUE(ring_buffer_enqueue(rb, &values[i]));
+	
+	ASSERT_EQ(ring_buffer_dequeue_bulk(rb, items, 4), 4);
+	for (int i = 0; i < 4; i++)
+		ASSERT_EQ(*(int *)items[i], i);
+	ASSERT_EQ(ring_buffer_size(rb), 2);
+	
+	/* Batch across the wrap point, limited by the items queued */
+	for (int i = 6; i < 10; i++)
+		ASSERT_TRUE(ring_buffer_enqueue(rb, &values[i]));
+	
+	ASSERT_EQ(ring_buffer_dequeue_bulk(rb, items, 16), 6);
+	for (int i = 0; i < 6; i++)
+		ASSERT_EQ(*(int *)items[i], i + 4);
+	
+	ASSERT_TRUE(ring_buffer_is_empty(rb));
+	ASSERT_EQ(ring_buffer_dequeue_bulk(rb, items, 16), 0);
+	
+	ring_buffer_stats(rb, &enqueued, &dequeued, &overflows, &peak);
+	ASSERT_EQ(dequeued, 10);
+	
+	ring_buffer_destroy(rb);
+}
+
 /* Thread function for concurrent test */
 static void *producer_thread(void *arg)
 {
@@ -190,11 +229,129 @@ TEST(ring_buffer_concurrent)
 	ring_buffer_destroy(rb);
 }
 
+TEST(ring_buffer_mpmc_bulk)
+{
+	struct ring_buffer *rb = ring_buffer_create_mpmc(8);
+	ASSERT_NOT_NULL(rb);
+	ASSERT_EQ(ring_buffer_capacity(rb), 8);
+	
+	int values[12];
+	void *items[12];
+	
+	for (int i = 0; i < 12; i++) {
+		values[i] = i;
+		items[i] = &values[i];
+	}
+	
+	/* Every slot is usable, the rest overflows */
+	ASSERT_EQ(ring_buffer_enqueue_bulk(rb, items, 12), 8);
+	ASSERT_TRUE(ring_buffer_is_full(rb));
+	ASSERT_FALSE(ring_buffer_enqueue(rb, &values[8]));
+	
+	ASSERT_EQ(ring_buffer_dequeue_bulk(rb, items, 5), 5);
+	for (int i = 0; i < 5; i++)
+		ASSERT_EQ(*(int *)items[i], i);
+	
+	/* Wrap around */
+	ASSERT_TRUE(ring_buffer_enqueue(rb, &values[8]));
+	ASSERT_EQ(ring_buffer_size(rb), 4);
+	
+	ASSERT_EQ(ring_buffer_dequeue_bulk(rb, items, 12), 4);
+	for (int i = 0; i < 4; i++)
+		ASSERT_EQ(*(int *)items[i], i + 5);
+	
+	ASSERT_TRUE(ring_buffer_is_empty(rb));
+	ASSERT_NULL(ring_buffer_dequeue(rb));
+	
+	ring_buffer_destroy(rb);
+}
+
+#define MPMC_THREADS 4
+#define MPMC_ITEMS 10000
+
+static int mpmc_values[MPMC_ITEMS];
+static atomic_long mpmc_consumed;
+static atomic_long mpmc_sum;
+
+static void *mpmc_producer_thread(void *arg)
+{
+	struct ring_buffer *rb = (struct ring_buffer *)arg;
+	
+	for (int i = 0; i < MPMC_ITEMS; i += 4) {
+		void *items[4];
+		size_t n = 0;
+		
+		for (int j = 0; j < 4; j++)
+			items[j] = &mpmc_values[i + j];
+		
+		/* Spin until the whole run is queued */
+		while (n < 4)
+			n += ring_buffer_enqueue_bulk(rb, items + n, 4 - n);
+	}
+	
+	return NULL;
+}
+
+static void *mpmc_consumer_thread(void *arg)
+{
+	struct ring_buffer *rb = (struct ring_buffer *)arg;
+	void *items[16];
+	
+	while (atomic_load(&mpmc_consumed) < (long)MPMC_THREADS * MPMC_ITEMS) {
+		size_t n = ring_buffer_dequeue_bulk(rb, items, 16);
+		
+		for (size_t i = 0; i < n; i++)
+			atomic_fetch_add(&mpmc_sum, *(int *)items[i]);
+		atomic_fetch_add(&mpmc_consumed, n);
+	}
+	
+	return NULL;
+}
+
+TEST(ring_buffer_mpmc_concurrent)
+{
+	struct ring_buffer *rb = ring_buffer_create_mpmc(64);
+	ASSERT_NOT_NULL(rb);
+	
+	pthread_t prod[MPMC_THREADS], cons[MPMC_THREADS];
+	unsigned long enqueued, dequeued, overflows, peak;
+	
+	for (int i = 0; i < MPMC_ITEMS; i++)
+		mpmc_values[i] = i;
+	atomic_store(&mpmc_consumed, 0);
+	atomic_store(&mpmc_sum, 0);
+	
+	for (int i = 0; i < MPMC_THREADS; i++) {
+		pthread_create(&prod[i], NULL, mpmc_producer_thread, rb);
+		pthread_create(&cons[i], NULL, mpmc_consumer_thread, rb);
+	}
+	
+	for (int i = 0; i < MPMC_THREADS; i++) {
+		pthread_join(prod[i], NULL);
+		pthread_join(cons[i], NULL);
+	}
+	
+	/* Every item consumed exactly once */
+	ASSERT_EQ(atomic_load(&mpmc_consumed), (long)MPMC_THREADS * MPMC_ITEMS);
+	ASSERT_EQ(atomic_load(&mpmc_sum),
+	          (long)MPMC_THREADS * MPMC_ITEMS * (MPMC_ITEMS - 1) / 2);
+	ASSERT_TRUE(ring_buffer_is_empty(rb));
+	
+	ring_buffer_stats(rb, &enqueued, &dequeued, &overflows, &peak);
+	ASSERT_EQ(enqueued, (unsigned long)MPMC_THREADS * MPMC_ITEMS);
+	ASSERT_EQ(dequeued, (unsigned long)MPMC_THREADS * MPMC_ITEMS);
+	
+	ring_buffer_destroy(rb);
+}
+
 TEST_SUITE_BEGIN("Ring Buffer")
 	RUN_TEST(ring_buffer_create_destroy);
 	RUN_TEST(ring_buffer_enqueue_dequeue);
 	RUN_TEST(ring_buffer_full);
 	RUN_TEST(ring_buffer_wrap_around);
 	RUN_TEST(ring_buffer_stats);
+	RUN_TEST(ring_buffer_dequeue_bulk);
 	RUN_TEST(ring_buffer_concurrent);
+	RUN_TEST(ring_buffer_mpmc_bulk);
+	RUN_TEST(ring_buffer_mpmc_concurrent);
 TEST_SUITE_END()
@@ -0,0 +1,197 @@
+/* test_security_detector.c - Unit tests for detector dispatch and sharding */
+
+#include "test_framework.h"
+#include "security_detector.h"
+#include "event_processor.h"
+#include "fib_mirror.h"
+#include "nlmon_nl_route.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#define STORM_THREADS 4
+#define STORM_EVENTS 1000
+
+/* Security events reported, by type */
+static atomic_int reported[SECURITY_NEIGHBOR_SPOOF + 1];
+
+static void count_event(struct security_event *event, void *ctx)
+{
+	(void)ctx;
+	atomic_fetch_add(&reported[event->type], 1);
+}
+
+static void reset_reported(void)
+{
+	for (size_t i = 0; i < sizeof(reported) / sizeof(reported[0]); i++)
+		atomic_store(&reported[i], 0);
+}
+
+static void make_event(struct nlmon_event *event, uint16_t type, const char *interface)
+{
+	memset(event, 0, sizeof(*event));
+	event->message_type = type;
+	event->netlink.protocol = NETLINK_ROUTE;
+	snprintf(event->interface, sizeof(event->interface), "%s", interface);
+}
+
+/* Storm config whose window does not end during a test */
+static struct security_detector *create_detector(struct security_detector_config *config)
+{
+	struct security_detector *sd;
+	
+	config->interface_storm_window = 1000000;
+	sd = security_detector_create(config);
+	if (sd)
+		security_detector_register_callback(sd, count_event, NULL);
+	reset_reported();
+	return sd;
+}
+
+TEST(security_detector_dispatch)
+{
+	struct security_detector_config config = {
+		.enable_suspicious_interface_detection = true,
+		.enable_interface_storm_detection = true,
+		.interface_storm_threshold = 2,
+	};
+	struct security_detector *sd = create_detector(&config);
+	struct nlmon_event event;
+	uint32_t flags = IFF_PROMISC;
+	
+	ASSERT_NOT_NULL(sd);
+	
+	/* A new link runs the link detectors registered for it */
+	make_event(&event, RTM_NEWLINK, "test0");
+	ASSERT_TRUE(security_detector_process_event(sd, &event));
+	ASSERT_EQ(atomic_load(&reported[SECURITY_SUSPICIOUS_INTERFACE]), 1);
+	ASSERT_EQ(atomic_load(&reported[SECURITY_INTERFACE_STORM]), 0);
+	
+	/* A deleted link runs only the storm detector */
+	make_event(&event, RTM_DELLINK, "test0");
+	ASSERT_TRUE(security_detector_process_event(sd, &event));
+	ASSERT_EQ(atomic_load(&reported[SECURITY_SUSPICIOUS_INTERFACE]), 1);
+	ASSERT_EQ(atomic_load(&reported[SECURITY_INTERFACE_STORM]), 1);
+	
+	/* Disabled detectors are not registered */
+	make_event(&event, RTM_NEWLINK, "eth0");
+	event.data = &flags;
+	event.data_size = sizeof(flags);
+	ASSERT_FALSE(security_detector_process_event(sd, &event));
+	ASSERT_EQ(atomic_load(&reported[SECURITY_PROMISCUOUS_MODE]), 0);
+	
+	/* Types no detector handles */
+	make_event(&event, RTM_NEWADDR, "test1");
+	ASSERT_FALSE(security_detector_process_event(sd, &event));
+	make_event(&event, 0xffff, "test1");
+	ASSERT_FALSE(security_detector_process_event(sd, &event));
+	ASSERT_EQ(atomic_load(&reported[SECURITY_SUSPICIOUS_INTERFACE]), 1);
+	
+	security_detector_destroy(sd);
+	
+	config.enable_promisc_detection = true;
+	sd = create_detector(&config);
+	ASSERT_NOT_NULL(sd);
+	make_event(&event, RTM_NEWLINK, "eth0");
+	event.data = &flags;
+	event.data_size = sizeof(flags);
+	ASSERT_TRUE(security_detector_process_event(sd, &event));
+	ASSERT_EQ(atomic_load(&reported[SECURITY_PROMISCUOUS_MODE]), 1);
+	security_detector_destroy(sd);
+}
+
+TEST(security_detector_mirrors_always_run)
+{
+	struct security_detector_config config = { 0 };
+	struct security_detector *sd = create_detector(&config);
+	struct nlmon_route_info route;
+	struct nlmon_event event;
+	size_t routes;
+	
+	ASSERT_NOT_NULL(sd);
+	
+	/* The route mirror is kept with hijack detection disabled */
+	memset(&route, 0, sizeof(route));
+	route.family = AF_INET;
+	route.dst_len = 24;
+	route.type = RTN_UNICAST;
+	route.table = RT_TABLE_MAIN;
+	route.oif = 2;
+	snprintf(route.dst, sizeof(route.dst), "10.0.0.0");
+	make_event(&event, RTM_NEWROUTE, "eth0");
+	event.netlink.data.route = &route;
+	ASSERT_FALSE(security_detector_process_event(sd, &event));
+	fib_mirror_stats(security_detector_routes(sd), &routes, NULL, NULL);
+	ASSERT_EQ(routes, 1);
+	
+	event.message_type = RTM_DELROUTE;
+	ASSERT_FALSE(security_detector_process_event(sd, &event));
+	fib_mirror_stats(security_detector_routes(sd), &routes, NULL, NULL);
+	ASSERT_EQ(routes, 0);
+	
+	security_detector_destroy(sd);
+}
+
+struct storm_worker {
+	struct security_detector *sd;
+	char interface[IFNAMSIZ];
+};
+
+static void *storm_thread(void *arg)
+{
+	struct storm_worker *worker = arg;
+	struct nlmon_event event;
+	
+	for (int i = 0; i < STORM_EVENTS; i++) {
+		make_event(&event, i % 2 ? RTM_DELLINK : RTM_NEWLINK, worker->interface);
+		security_detector_process_event(worker->sd, &event);
+	}
+	return NULL;
+}
+
+TEST(security_detector_concurrent_interfaces)
+{
+	struct security_detector_config config = {
+		.enable_interface_storm_detection = true,
+		.interface_storm_threshold = 10,
+	};
+	struct security_detector *sd = create_detector(&config);
+	struct storm_worker workers[STORM_THREADS];
+	pthread_t threads[STORM_THREADS];
+	unsigned long processed;
+	
+	ASSERT_NOT_NULL(sd);
+	
+	/* Workers feeding their own interfaces count every event */
+	for (int i = 0; i < STORM_THREADS; i++) {
+		workers[i].sd = sd;
+		snprintf(workers[i].interface, sizeof(workers[i].interface), "eth%d", i);
+		ASSERT_EQ(pthread_create(&threads[i], NULL, storm_thread, &workers[i]), 0);
+	}
+	for (int i = 0; i < STORM_THREADS; i++)
+		pthread_join(threads[i], NULL);
+	
+	security_detector_stats(sd, &processed, NULL, NULL, NULL, NULL);
+	ASSERT_EQ(processed, STORM_THREADS * STORM_EVENTS);
+	ASSERT_EQ(atomic_load(&reported[SECURITY_INTERFACE_STORM]),
+	          STORM_THREADS * STORM_EVENTS / 10);
+	
+	/* Reset starts every shard from zero */
+	security_detector_reset(sd);
+	reset_reported();
+	storm_thread(&workers[0]);
+	ASSERT_EQ(atomic_load(&reported[SECURITY_INTERFACE_STORM]), STORM_EVENTS / 10);
+	
+	security_detector_destroy(sd);
+}
+
+TEST_SUITE_BEGIN("Security Detector")
+	RUN_TEST(security_detector_dispatch);
+	RUN_TEST(security_detector_mirrors_always_run);
+	RUN_TEST(security_detector_concurrent_interfaces);
+TEST_SUITE_END()
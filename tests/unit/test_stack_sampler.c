@@ -0,0 +1,108 @@
+/* test_stack_sampler.c - Unit tests for the stack sampling profiler */
+
+#define _GNU_SOURCE
+#include "test_framework.h"
+#include "stack_sampler.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+
+static _Atomic bool spinning;
+
+/* Named in the samples, the test is linked with -rdynamic */
+__attribute__((noinline)) void sampler_busy_spin(void)
+{
+	volatile uint64_t x = 0;
+	
+	while (atomic_load_explicit(&spinning, memory_order_relaxed))
+		x++;
+}
+
+static void *spin_thread(void *arg)
+{
+	pthread_setname_np(pthread_self(), "spinner");
+	sampler_busy_spin();
+	return NULL;
+}
+
+static void *capture_thread(void *arg)
+{
+	return stack_sampler_capture(1, 200);
+}
+
+TEST(capture_busy_thread)
+{
+	struct stack_profile *profile;
+	pthread_t spinner;
+	size_t len;
+	char *folded;
+	
+	atomic_store(&spinning, true);
+	ASSERT_EQ(pthread_create(&spinner, NULL, spin_thread, NULL), 0);
+	
+	profile = stack_sampler_capture(1, 200);
+	atomic_store(&spinning, false);
+	pthread_join(spinner, NULL);
+	
+	ASSERT_NOT_NULL(profile);
+	ASSERT_TRUE(stack_profile_samples(profile) > 50);
+	ASSERT_EQ(stack_profile_dropped(profile), 0);
+	
+	/* Nearly all the CPU went to the spinning thread */
+	ASSERT_TRUE(stack_profile_share(profile, "sampler_busy_spin") > 80.0);
+	ASSERT_EQ(stack_profile_share(profile, "no_such_function"), 0);
+	
+	folded = stack_profile_folded(profile, &len);
+	ASSERT_NOT_NULL(folded);
+	ASSERT_EQ(len, strlen(folded));
+	ASSERT_NOT_NULL(strstr(folded, "spinner;"));
+	ASSERT_NOT_NULL(strstr(folded, ";sampler_busy_spin"));
+	ASSERT_TRUE(folded[len - 1] == '\n');
+	
+	free(folded);
+	stack_profile_free(profile);
+}
+
+TEST(one_capture_at_a_time)
+{
+	struct stack_profile *profile;
+	pthread_t other;
+	void *result;
+	
+	ASSERT_EQ(pthread_create(&other, NULL, capture_thread, NULL), 0);
+	usleep(200000);
+	
+	errno = 0;
+	ASSERT_NULL(stack_sampler_capture(1, 0));
+	ASSERT_EQ(errno, EBUSY);
+	
+	pthread_join(other, &result);
+	ASSERT_NOT_NULL(result);
+	stack_profile_free(result);
+	
+	/* Free again once it is over */
+	profile = stack_sampler_capture(1, 0);
+	ASSERT_NOT_NULL(profile);
+	stack_profile_free(profile);
+}
+
+TEST(invalid_arguments)
+{
+	errno = 0;
+	ASSERT_NULL(stack_sampler_capture(0, 0));
+	ASSERT_EQ(errno, EINVAL);
+	ASSERT_NULL(stack_sampler_capture(STACK_SAMPLER_MAX_SECONDS + 1, 0));
+	ASSERT_NULL(stack_sampler_capture(1, STACK_SAMPLER_MAX_HZ + 1));
+	
+	ASSERT_EQ(stack_profile_samples(NULL), 0);
+	ASSERT_NULL(stack_profile_folded(NULL, NULL));
+	stack_profile_free(NULL);
+}
+
+TEST_SUITE_BEGIN("Stack Sampler")
+	RUN_TEST(capture_busy_thread);
+	RUN_TEST(one_capture_at_a_time);
+	RUN_TEST(invalid_arguments);
+TEST_SUITE_END()
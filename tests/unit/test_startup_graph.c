@@ -0,0 +1,139 @@
+/* test_startup_graph.c - Unit tests for the subsystem startup graph */
+
+#include "test_framework.h"
+#include "startup_graph.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+static _Atomic int order_next;
+
+struct phase_arg {
+	int order;              /* Position the phase finished in */
+	int result;
+	unsigned int sleep_us;
+};
+
+static int record_phase(void *arg)
+{
+	struct phase_arg *p = arg;
+	
+	usleep(p->sleep_us);
+	p->order = atomic_fetch_add(&order_next, 1);
+	return p->result;
+}
+
+TEST(startup_parallel_after_deps)
+{
+	struct startup_graph *graph = startup_graph_create();
+	struct phase_arg a = { 0, 0, 20000 }, b = { 0, 0, 100000 }, c = { 0, 0, 100000 }, d = { 0, 0, 0 };
+	struct startup_phase_info bi, ci, di;
+	int ia, ib, ic, id;
+	
+	ASSERT_NOT_NULL(graph);
+	atomic_store(&order_next, 0);
+	
+	id = startup_graph_add(graph, "d", record_phase, &d, 0);
+	ib = startup_graph_add(graph, "b", record_phase, &b, 0);
+	ic = startup_graph_add(graph, "c", record_phase, &c, 0);
+	ia = startup_graph_add(graph, "a", record_phase, &a, STARTUP_REQUIRED);
+	ASSERT_EQ(startup_graph_depend(graph, ib, ia), 0);
+	ASSERT_EQ(startup_graph_depend(graph, ic, ia), 0);
+	ASSERT_EQ(startup_graph_depend(graph, id, ib), 0);
+	ASSERT_EQ(startup_graph_depend(graph, id, ic), 0);
+	ASSERT_EQ(startup_graph_depend(graph, ia, id), -ELOOP);
+	ASSERT_EQ(startup_graph_depend(graph, ia, ia), -ELOOP);
+	
+	ASSERT_EQ(startup_graph_run(graph, 4), 0);
+	ASSERT_EQ(a.order, 0);
+	ASSERT_EQ(d.order, 3);
+	
+	/* b and c ran side by side, d only once both were done */
+	ASSERT_EQ(startup_graph_info(graph, ib, &bi), 0);
+	ASSERT_EQ(startup_graph_info(graph, ic, &ci), 0);
+	ASSERT_EQ(startup_graph_info(graph, id, &di), 0);
+	ASSERT_STR_EQ(di.name, "d");
+	ASSERT_EQ(di.state, STARTUP_DONE);
+	ASSERT_TRUE(ci.start_ns < bi.start_ns + bi.duration_ns);
+	ASSERT_TRUE(bi.start_ns < ci.start_ns + ci.duration_ns);
+	ASSERT_TRUE(di.start_ns >= bi.start_ns + bi.duration_ns);
+	ASSERT_TRUE(di.start_ns >= ci.start_ns + ci.duration_ns);
+	ASSERT_TRUE(bi.duration_ns >= 100000000ULL);
+	
+	ASSERT_EQ(startup_graph_add(graph, "late", record_phase, &a, 0), -EBUSY);
+	ASSERT_EQ(startup_graph_run(graph, 4), -EBUSY);
+	startup_graph_destroy(graph);
+}
+
+TEST(startup_failures)
+{
+	struct startup_graph *graph = startup_graph_create();
+	struct phase_arg ok = { 0, 0, 0 }, bad = { 0, -EIO, 0 }, after = { 0, 0, 0 }, opt = { 0, -ENODEV, 0 };
+	int ibad, iafter, iopt;
+	
+	ASSERT_NOT_NULL(graph);
+	
+	startup_graph_add(graph, "ok", record_phase, &ok, STARTUP_REQUIRED);
+	iopt = startup_graph_add(graph, "optional", record_phase, &opt, 0);
+	ibad = startup_graph_add(graph, "bad", record_phase, &bad, 0);
+	iafter = startup_graph_add(graph, "after", record_phase, &after, STARTUP_REQUIRED);
+	startup_graph_depend(graph, iafter, ibad);
+	
+	/* A required phase that is skipped fails the run, optional ones do not */
+	ASSERT_EQ(startup_graph_run(graph, 1), -ECANCELED);
+	ASSERT_EQ(startup_graph_state(graph, iopt), STARTUP_FAILED);
+	ASSERT_EQ(startup_graph_state(graph, ibad), STARTUP_FAILED);
+	ASSERT_EQ(startup_graph_state(graph, iafter), STARTUP_SKIPPED);
+	startup_graph_destroy(graph);
+	
+	graph = startup_graph_create();
+	ASSERT_NOT_NULL(graph);
+	startup_graph_add(graph, "optional", record_phase, &opt, 0);
+	startup_graph_add(graph, "bad", record_phase, &bad, STARTUP_REQUIRED);
+	ASSERT_EQ(startup_graph_run(graph, 2), -EIO);
+	startup_graph_destroy(graph);
+}
+
+TEST(startup_lazy)
+{
+	struct startup_graph *graph = startup_graph_create();
+	struct phase_arg base = { 0, 0, 0 }, lazy = { 0, 0, 20000 }, early = { 0, 0, 0 }, idle = { 0, 0, 0 };
+	int ibase, ilazy, iearly, iidle;
+	
+	ASSERT_NOT_NULL(graph);
+	
+	ibase = startup_graph_add(graph, "base", record_phase, &base, 0);
+	ilazy = startup_graph_add(graph, "lazy", record_phase, &lazy, STARTUP_LAZY);
+	iearly = startup_graph_add(graph, "early", record_phase, &early, STARTUP_LAZY);
+	iidle = startup_graph_add(graph, "idle", record_phase, &idle, STARTUP_LAZY);
+	startup_graph_depend(graph, ilazy, ibase);
+	
+	/* Started before the run, it simply joins it */
+	ASSERT_EQ(startup_graph_start(graph, iearly), 0);
+	ASSERT_EQ(startup_graph_run(graph, 2), 0);
+	ASSERT_EQ(startup_graph_state(graph, iearly), STARTUP_DONE);
+	ASSERT_EQ(startup_graph_state(graph, ilazy), STARTUP_PENDING);
+	ASSERT_EQ(startup_graph_wait(graph, ilazy), STARTUP_PENDING);
+	
+	/* First use starts it, later ones find it running or done */
+	ASSERT_EQ(startup_graph_start(graph, ilazy), 0);
+	ASSERT_EQ(startup_graph_start(graph, ilazy), 0);
+	ASSERT_EQ(startup_graph_wait(graph, ilazy), STARTUP_DONE);
+	ASSERT_EQ(startup_graph_state(graph, iidle), STARTUP_PENDING);
+	
+	ASSERT_EQ(startup_graph_start(graph, 99), -EINVAL);
+	ASSERT_EQ(startup_graph_state(graph, 99), STARTUP_SKIPPED);
+	ASSERT_EQ(startup_graph_count(graph), 4);
+	ASSERT_STR_EQ(startup_state_name(STARTUP_SKIPPED), "skipped");
+	
+	/* Destroy waits for lazy phases still running */
+	ASSERT_EQ(startup_graph_start(graph, iidle), 0);
+	startup_graph_destroy(graph);
+	ASSERT_TRUE(idle.order > 0);
+}
+
+TEST_SUITE_BEGIN("Startup Graph")
+	RUN_TEST(startup_parallel_after_deps);
+	RUN_TEST(startup_failures);
+	RUN_TEST(startup_lazy);
+TEST_SUITE_END()
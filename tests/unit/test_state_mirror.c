@@ -0,0 +1,236 @@
+/* test_state_mirror.c - Unit tests for the neighbor and conntrack mirrors */
+
+#include "test_framework.h"
+#include "state_mirror.h"
+#include "nlmon_nl_route.h"
+#include "nlmon_nl_netfilter.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+
+static struct nlmon_neigh_info make_neigh(int ifindex, const char *dst, unsigned char last)
+{
+	struct nlmon_neigh_info neigh;
+	
+	memset(&neigh, 0, sizeof(neigh));
+	neigh.family = strchr(dst, ':') ? AF_INET6 : AF_INET;
+	neigh.ifindex = ifindex;
+	neigh.state = NUD_REACHABLE;
+	snprintf(neigh.dst, sizeof(neigh.dst), "%s", dst);
+	if (last) {
+		neigh.lladdr[0] = 0x02;
+		neigh.lladdr[5] = last;
+	}
+	return neigh;
+}
+
+static struct nlmon_ct_info make_flow(const char *src, uint16_t sport, const char *dst,
+                                      uint16_t dport)
+{
+	struct nlmon_ct_info ct;
+	
+	memset(&ct, 0, sizeof(ct));
+	ct.protocol = IPPROTO_TCP;
+	snprintf(ct.src_addr, sizeof(ct.src_addr), "%s", src);
+	snprintf(ct.dst_addr, sizeof(ct.dst_addr), "%s", dst);
+	ct.src_port = sport;
+	ct.dst_port = dport;
+	return ct;
+}
+
+static bool count_neigh(const struct neigh_mirror_entry *entry, void *ctx)
+{
+	(*(int *)ctx)++;
+	return true;
+}
+
+static bool first_flow(const struct ct_mirror_entry *entry, void *ctx)
+{
+	*(uint16_t *)ctx = entry->src_port;
+	return false;
+}
+
+TEST(neigh_mirror_tracks_state)
+{
+	struct neigh_mirror *mirror = neigh_mirror_create(0);
+	struct neigh_mirror_entry entry, prev;
+	struct nlmon_neigh_info neigh;
+	int count = 0;
+	
+	ASSERT_NOT_NULL(mirror);
+	
+	neigh = make_neigh(2, "192.168.1.10", 0xaa);
+	ASSERT_EQ(neigh_mirror_update(mirror, RTM_NEWNEIGH, &neigh, 100, &prev), 0);
+	ASSERT_TRUE(neigh_mirror_lookup(mirror, 2, "192.168.1.10", &entry));
+	ASSERT_EQ(entry.lladdr[5], 0xaa);
+	ASSERT_EQ(entry.state, NUD_REACHABLE);
+	ASSERT_EQ(entry.first_seen, 100);
+	
+	/* Keyed by interface and address */
+	ASSERT_FALSE(neigh_mirror_lookup(mirror, 3, "192.168.1.10", &entry));
+	ASSERT_FALSE(neigh_mirror_lookup(mirror, 2, "192.168.1.11", &entry));
+	
+	/* Updates hand back the previous state, a missing address is kept */
+	neigh = make_neigh(2, "192.168.1.10", 0);
+	neigh.state = NUD_FAILED;
+	ASSERT_EQ(neigh_mirror_update(mirror, RTM_NEWNEIGH, &neigh, 200, &prev), 1);
+	ASSERT_EQ(prev.state, NUD_REACHABLE);
+	ASSERT_TRUE(neigh_mirror_lookup(mirror, 2, "192.168.1.10", &entry));
+	ASSERT_EQ(entry.state, NUD_FAILED);
+	ASSERT_EQ(entry.lladdr[5], 0xaa);
+	ASSERT_EQ(entry.lladdr_changed, 100);
+	ASSERT_EQ(entry.updated, 200);
+	
+	neigh = make_neigh(2, "192.168.1.10", 0xbb);
+	ASSERT_EQ(neigh_mirror_update(mirror, RTM_NEWNEIGH, &neigh, 300, &prev), 1);
+	ASSERT_EQ(prev.lladdr[5], 0xaa);
+	ASSERT_TRUE(neigh_mirror_lookup(mirror, 2, "192.168.1.10", &entry));
+	ASSERT_EQ(entry.lladdr_changed, 300);
+	
+	neigh = make_neigh(2, "fe80::1", 0xcc);
+	ASSERT_EQ(neigh_mirror_update(mirror, RTM_NEWNEIGH, &neigh, 300, NULL), 0);
+	ASSERT_EQ(neigh_mirror_walk(mirror, count_neigh, &count), 2);
+	ASSERT_EQ(count, 2);
+	
+	ASSERT_EQ(neigh_mirror_update(mirror, RTM_DELNEIGH, &neigh, 400, &prev), 1);
+	ASSERT_EQ(neigh_mirror_update(mirror, RTM_DELNEIGH, &neigh, 400, &prev), -ENOENT);
+	ASSERT_FALSE(neigh_mirror_lookup(mirror, 2, "fe80::1", &entry));
+	
+	neigh = make_neigh(2, "not an address", 0xcc);
+	ASSERT_EQ(neigh_mirror_update(mirror, RTM_NEWNEIGH, &neigh, 400, NULL), -EINVAL);
+	
+	neigh_mirror_destroy(mirror);
+}
+
+TEST(neigh_mirror_turns_away_when_full)
+{
+	struct neigh_mirror *mirror = neigh_mirror_create(100);
+	struct neigh_mirror_entry entry;
+	struct nlmon_neigh_info neigh;
+	uint64_t rejected;
+	size_t entries;
+	char dst[32];
+	int i;
+	
+	for (i = 0; i < 150; i++) {
+		snprintf(dst, sizeof(dst), "10.0.%d.%d", i / 256, i % 256);
+		neigh = make_neigh(2, dst, (unsigned char)i);
+		ASSERT_EQ(neigh_mirror_update(mirror, RTM_NEWNEIGH, &neigh, i, NULL),
+		          i < 100 ? 0 : -ENOSPC);
+	}
+	
+	/* The first neighbors stay and can still be updated */
+	ASSERT_TRUE(neigh_mirror_lookup(mirror, 2, "10.0.0.0", &entry));
+	ASSERT_FALSE(neigh_mirror_lookup(mirror, 2, "10.0.0.120", &entry));
+	neigh = make_neigh(2, "10.0.0.0", 0xff);
+	ASSERT_EQ(neigh_mirror_update(mirror, RTM_NEWNEIGH, &neigh, 500, NULL), 1);
+	
+	neigh_mirror_stats(mirror, &entries, &rejected);
+	ASSERT_EQ(entries, 100);
+	ASSERT_EQ(rejected, 50);
+	
+	neigh_mirror_destroy(mirror);
+}
+
+TEST(ct_mirror_tracks_flows)
+{
+	struct ct_mirror *mirror = ct_mirror_create(0);
+	struct ct_mirror_entry entry;
+	struct nlmon_ct_info ct;
+	
+	ASSERT_NOT_NULL(mirror);
+	
+	ct = make_flow("10.0.0.1", 40000, "10.0.0.2", 443);
+	ct.tcp_state = 1;
+	ct.packets_orig = 3;
+	ASSERT_EQ(ct_mirror_update(mirror, IPCTNL_MSG_CT_NEW, &ct, 100), 0);
+	
+	/* Counters only move when reported */
+	ct.tcp_state = 3;
+	ct.packets_orig = 0;
+	ASSERT_EQ(ct_mirror_update(mirror, IPCTNL_MSG_CT_NEW, &ct, 200), 1);
+	ASSERT_TRUE(ct_mirror_lookup(mirror, &ct, &entry));
+	ASSERT_EQ(entry.tcp_state, 3);
+	ASSERT_EQ(entry.packets_orig, 3);
+	ASSERT_EQ(entry.first_seen, 100);
+	ASSERT_EQ(entry.updated, 200);
+	ASSERT_STR_EQ(entry.dst_addr, "10.0.0.2");
+	ASSERT_EQ(entry.family, AF_INET);
+	
+	/* Each part of the tuple counts */
+	ct.dst_port = 80;
+	ASSERT_FALSE(ct_mirror_lookup(mirror, &ct, &entry));
+	ct = make_flow("10.0.0.1", 40000, "10.0.0.2", 443);
+	ct.protocol = IPPROTO_UDP;
+	ASSERT_FALSE(ct_mirror_lookup(mirror, &ct, &entry));
+	
+	ct = make_flow("2001:db8::1", 5000, "2001:db8::2", 53);
+	ASSERT_EQ(ct_mirror_update(mirror, IPCTNL_MSG_CT_NEW, &ct, 300), 0);
+	ASSERT_TRUE(ct_mirror_lookup(mirror, &ct, &entry));
+	ASSERT_EQ(entry.family, AF_INET6);
+	
+	ASSERT_EQ(ct_mirror_update(mirror, IPCTNL_MSG_CT_DELETE, &ct, 400), 1);
+	ASSERT_EQ(ct_mirror_update(mirror, IPCTNL_MSG_CT_DELETE, &ct, 400), -ENOENT);
+	ASSERT_FALSE(ct_mirror_lookup(mirror, &ct, &entry));
+	
+	ct = make_flow("", 1, "10.0.0.2", 2);
+	ASSERT_EQ(ct_mirror_update(mirror, IPCTNL_MSG_CT_NEW, &ct, 400), -EINVAL);
+	
+	ct_mirror_destroy(mirror);
+}
+
+TEST(ct_mirror_evicts_least_recent)
+{
+	struct ct_mirror *mirror = ct_mirror_create(64);
+	struct ct_mirror_entry entry;
+	struct nlmon_ct_info ct;
+	uint16_t newest = 0;
+	uint64_t evicted;
+	size_t entries;
+	int i;
+	
+	for (i = 0; i < 64; i++) {
+		ct = make_flow("10.0.0.1", (uint16_t)(1000 + i), "10.0.0.2", 80);
+		ASSERT_EQ(ct_mirror_update(mirror, IPCTNL_MSG_CT_NEW, &ct, i), 0);
+	}
+	
+	/* Refreshed, the oldest flow outlives the next ones */
+	ct = make_flow("10.0.0.1", 1000, "10.0.0.2", 80);
+	ASSERT_EQ(ct_mirror_update(mirror, IPCTNL_MSG_CT_NEW, &ct, 100), 1);
+	
+	for (i = 0; i < 10; i++) {
+		ct = make_flow("10.0.0.3", (uint16_t)(2000 + i), "10.0.0.2", 80);
+		ASSERT_EQ(ct_mirror_update(mirror, IPCTNL_MSG_CT_NEW, &ct, 200 + i), 0);
+	}
+	
+	ct = make_flow("10.0.0.1", 1000, "10.0.0.2", 80);
+	ASSERT_TRUE(ct_mirror_lookup(mirror, &ct, &entry));
+	for (i = 1; i <= 10; i++) {
+		ct = make_flow("10.0.0.1", (uint16_t)(1000 + i), "10.0.0.2", 80);
+		ASSERT_FALSE(ct_mirror_lookup(mirror, &ct, &entry));
+	}
+	ct = make_flow("10.0.0.1", 1011, "10.0.0.2", 80);
+	ASSERT_TRUE(ct_mirror_lookup(mirror, &ct, &entry));
+	
+	ct_mirror_stats(mirror, &entries, &evicted);
+	ASSERT_EQ(entries, 64);
+	ASSERT_EQ(evicted, 10);
+	
+	/* Walks start at the most recent */
+	ASSERT_EQ(ct_mirror_walk(mirror, first_flow, &newest), 1);
+	ASSERT_EQ(newest, 2009);
+	
+	ct_mirror_destroy(mirror);
+}
+
+TEST_SUITE_BEGIN("State Mirrors")
+	RUN_TEST(neigh_mirror_tracks_state);
+	RUN_TEST(neigh_mirror_turns_away_when_full);
+	RUN_TEST(ct_mirror_tracks_flows);
+	RUN_TEST(ct_mirror_evicts_least_recent);
+TEST_SUITE_END()
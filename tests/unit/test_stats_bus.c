@@ -0,0 +1,161 @@
+/* test_stats_bus.c - Unit tests for the stats aggregation bus */
+
+#include "test_framework.h"
+#include "stats_bus.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+
+static _Atomic uint64_t collected;
+
+/* Fills every counter with the same value, so torn reads show */
+static void collect_counter(struct nlmon_stats_snapshot *snapshot, void *ctx)
+{
+	uint64_t value = atomic_fetch_add(&collected, 1) + 1;
+	
+	snapshot->events.submitted = value;
+	snapshot->events.processed = value;
+	snapshot->storage.db_event_count = value;
+	snapshot->netlink.total_messages_processed = value;
+	snapshot->plugins[STATS_BUS_MAX_PLUGINS - 1].events_processed = value;
+	snapshot->have |= STATS_HAVE_EVENTS | STATS_HAVE_STORAGE;
+}
+
+static void collect_plugins(struct nlmon_stats_snapshot *snapshot, void *ctx)
+{
+	snapshot->num_plugins = 1;
+	strcpy(snapshot->plugins[0].name, ctx);
+	snapshot->have |= STATS_HAVE_PLUGINS;
+}
+
+static void count_notify(const struct nlmon_stats_snapshot *snapshot, void *ctx)
+{
+	uint64_t *last = ctx;
+	
+	*last = snapshot->generation;
+}
+
+TEST(publish_and_read)
+{
+	struct nlmon_stats_snapshot snapshot;
+	struct stats_bus *bus;
+	uint64_t notified = 0;
+	
+	atomic_store(&collected, 0);
+	bus = stats_bus_create(60000);
+	ASSERT_NOT_NULL(bus);
+	ASSERT_EQ(stats_bus_add_source(bus, collect_counter, NULL), 0);
+	ASSERT_EQ(stats_bus_add_source(bus, collect_plugins, "demo"), 0);
+	ASSERT_EQ(stats_bus_subscribe(bus, count_notify, &notified), 0);
+	
+	/* Nothing until the first publication */
+	ASSERT_EQ(stats_bus_generation(bus), 0);
+	ASSERT_FALSE(stats_bus_read(bus, &snapshot));
+	
+	ASSERT_EQ(stats_bus_start(bus), 0);
+	ASSERT_EQ(stats_bus_generation(bus), 1);
+	ASSERT_EQ(notified, 1);
+	ASSERT_TRUE(stats_bus_read(bus, &snapshot));
+	ASSERT_EQ(snapshot.generation, 1);
+	ASSERT_EQ(snapshot.events.submitted, 1);
+	ASSERT_EQ(snapshot.have, STATS_HAVE_EVENTS | STATS_HAVE_STORAGE | STATS_HAVE_PLUGINS);
+	ASSERT_EQ(snapshot.num_plugins, 1);
+	ASSERT_STR_EQ(snapshot.plugins[0].name, "demo");
+	ASSERT_TRUE(snapshot.timestamp_ms > 0);
+	
+	stats_bus_publish(bus);
+	ASSERT_EQ(stats_bus_generation(bus), 2);
+	ASSERT_EQ(notified, 2);
+	ASSERT_TRUE(stats_bus_read(bus, &snapshot));
+	ASSERT_EQ(snapshot.events.submitted, 2);
+	
+	stats_bus_destroy(bus);
+}
+
+TEST(sources_fixed_once_started)
+{
+	struct stats_bus *bus = stats_bus_create(60000);
+	
+	ASSERT_NOT_NULL(bus);
+	ASSERT_EQ(stats_bus_add_source(bus, NULL, NULL), -1);
+	for (int i = 0; i < STATS_BUS_MAX_SOURCES; i++)
+		ASSERT_EQ(stats_bus_add_source(bus, collect_counter, NULL), 0);
+	ASSERT_EQ(stats_bus_add_source(bus, collect_counter, NULL), -1);
+	
+	ASSERT_EQ(stats_bus_start(bus), 0);
+	ASSERT_EQ(stats_bus_start(bus), -1);
+	ASSERT_EQ(stats_bus_subscribe(bus, count_notify, NULL), -1);
+	
+	stats_bus_destroy(bus);
+	stats_bus_destroy(NULL);
+	ASSERT_EQ(stats_bus_generation(NULL), 0);
+}
+
+TEST(publishes_on_interval)
+{
+	struct stats_bus *bus = stats_bus_create(10);
+	
+	ASSERT_NOT_NULL(bus);
+	ASSERT_EQ(stats_bus_add_source(bus, collect_counter, NULL), 0);
+	ASSERT_EQ(stats_bus_start(bus), 0);
+	
+	usleep(200000);
+	ASSERT_TRUE(stats_bus_generation(bus) >= 5);
+	
+	stats_bus_destroy(bus);
+}
+
+static _Atomic bool reading;
+static _Atomic uint64_t torn;
+
+static void *reader_thread(void *arg)
+{
+	struct stats_bus *bus = arg;
+	struct nlmon_stats_snapshot snapshot;
+	
+	while (atomic_load(&reading)) {
+		if (!stats_bus_read(bus, &snapshot))
+			continue;
+		if (snapshot.events.processed != snapshot.events.submitted ||
+		    snapshot.storage.db_event_count != snapshot.events.submitted ||
+		    snapshot.netlink.total_messages_processed != snapshot.events.submitted ||
+		    snapshot.plugins[STATS_BUS_MAX_PLUGINS - 1].events_processed != snapshot.events.submitted)
+			atomic_fetch_add(&torn, 1);
+	}
+	return NULL;
+}
+
+TEST(concurrent_readers_see_whole_snapshots)
+{
+	struct stats_bus *bus = stats_bus_create(60000);
+	pthread_t readers[4];
+	
+	ASSERT_NOT_NULL(bus);
+	ASSERT_EQ(stats_bus_add_source(bus, collect_counter, NULL), 0);
+	ASSERT_EQ(stats_bus_start(bus), 0);
+	
+	atomic_store(&torn, 0);
+	atomic_store(&reading, true);
+	for (int i = 0; i < 4; i++)
+		ASSERT_EQ(pthread_create(&readers[i], NULL, reader_thread, bus), 0);
+	
+	for (int i = 0; i < 20000; i++)
+		stats_bus_publish(bus);
+	
+	atomic_store(&reading, false);
+	for (int i = 0; i < 4; i++)
+		pthread_join(readers[i], NULL);
+	
+	ASSERT_EQ(atomic_load(&torn), 0);
+	ASSERT_EQ(stats_bus_generation(bus), 20001);
+	
+	stats_bus_destroy(bus);
+}
+
+TEST_SUITE_BEGIN("Stats Bus")
+	RUN_TEST(publish_and_read);
+	RUN_TEST(sources_fixed_once_started);
+	RUN_TEST(publishes_on_interval);
+	RUN_TEST(concurrent_readers_see_whole_snapshots);
+TEST_SUITE_END()
@@ -0,0 +1,413 @@
+/* test_storage_buffer.c - Unit tests for the memory event buffer */
+
+#include "test_framework.h"
+#include "storage_buffer.h"
+#include "filter_parser.h"
+#include "event_processor.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void add_event(struct storage_buffer *sb, uint64_t timestamp, uint64_t sequence)
+{
+	struct nlmon_event event;
+	
+	memset(&event, 0, sizeof(event));
+	event.timestamp = timestamp;
+	event.sequence = sequence;
+	event.event_type = 1;
+	snprintf(event.interface, sizeof(event.interface), "eth%lu", sequence % 4);
+	storage_buffer_add(sb, &event);
+}
+
+TEST(storage_buffer_keyset_pages)
+{
+	struct storage_buffer *sb = storage_buffer_create(64);
+	struct buffer_event_header headers[5];
+	uint64_t timestamp = UINT64_MAX, sequence = UINT64_MAX;
+	uint64_t expect = 40;
+	size_t got;
+	
+	ASSERT_NOT_NULL(sb);
+	
+	/* Pairs of events share a timestamp, the sequence orders them */
+	for (uint64_t i = 1; i <= 40; i++)
+		add_event(sb, 1000 + (i + 1) / 2, i);
+	
+	/* Pages of five, newest first, each resuming after the last */
+	while ((got = storage_buffer_get_headers_before(sb, timestamp, sequence, 5, headers))) {
+		for (size_t i = 0; i < got; i++) {
+			ASSERT_EQ(headers[i].sequence, expect);
+			ASSERT_EQ(headers[i].timestamp, 1000 + (expect + 1) / 2);
+			expect--;
+		}
+		timestamp = headers[got - 1].timestamp;
+		sequence = headers[got - 1].sequence;
+	}
+	ASSERT_EQ(expect, 0);
+	
+	/* A key between two events of one timestamp */
+	got = storage_buffer_get_headers_before(sb, 1010, 20, 5, headers);
+	ASSERT_EQ(got, 5);
+	ASSERT_EQ(headers[0].sequence, 19);
+	
+	/* A key older than everything */
+	ASSERT_EQ(storage_buffer_get_headers_before(sb, 1000, 0, 5, headers), 0);
+	
+	storage_buffer_destroy(sb);
+}
+
+TEST(storage_buffer_keyset_evicted)
+{
+	struct storage_buffer *sb = storage_buffer_create(8);
+	struct buffer_event_header headers[16];
+	size_t got;
+	
+	ASSERT_NOT_NULL(sb);
+	for (uint64_t i = 1; i <= 20; i++)
+		add_event(sb, 2000 + i, i);
+	
+	/* Only what the buffer still holds */
+	got = storage_buffer_get_headers_before(sb, UINT64_MAX, UINT64_MAX, 16, headers);
+	ASSERT_EQ(got, 8);
+	ASSERT_EQ(headers[0].sequence, 20);
+	ASSERT_EQ(headers[7].sequence, 13);
+	
+	/* A key from before the eviction resumes at the oldest kept event */
+	got = storage_buffer_get_headers_before(sb, 2005, 5, 16, headers);
+	ASSERT_EQ(got, 0);
+	got = storage_buffer_get_headers_before(sb, 2015, 15, 16, headers);
+	ASSERT_EQ(got, 2);
+	ASSERT_EQ(headers[1].sequence, 13);
+	
+	storage_buffer_destroy(sb);
+}
+
+static void count_event(struct nlmon_event *event, void *ctx)
+{
+	(*(size_t *)ctx)++;
+}
+
+TEST(storage_buffer_limit_under_pressure)
+{
+	struct storage_buffer *sb = storage_buffer_create_indexed(32);
+	struct buffer_event_header headers[32];
+	struct buffer_query_filter filter;
+	size_t full, got, matched = 0;
+	
+	ASSERT_NOT_NULL(sb);
+	for (uint64_t i = 1; i <= 32; i++)
+		add_event(sb, 3000 + i, i);
+	full = storage_buffer_memory(sb);
+	
+	/* The oldest go at once, adds stay within the limit */
+	storage_buffer_set_limit(sb, 10);
+	ASSERT_EQ(storage_buffer_size(sb), 10);
+	ASSERT_EQ(storage_buffer_limit(sb), 10);
+	ASSERT_TRUE(storage_buffer_memory(sb) < full);
+	for (uint64_t i = 33; i <= 40; i++)
+		add_event(sb, 3000 + i, i);
+	ASSERT_EQ(storage_buffer_size(sb), 10);
+	
+	got = storage_buffer_get_headers_before(sb, UINT64_MAX, UINT64_MAX, 32, headers);
+	ASSERT_EQ(got, 10);
+	ASSERT_EQ(headers[0].sequence, 40);
+	ASSERT_EQ(headers[9].sequence, 31);
+	
+	/* Index chains lost the evicted events too */
+	memset(&filter, 0, sizeof(filter));
+	filter.interface_pattern = "eth1";
+	ASSERT_EQ(storage_buffer_query(sb, &filter, count_event, &matched), 2);
+	ASSERT_EQ(matched, 2);
+	
+	/* Lifted, the buffer fills up to its capacity again */
+	storage_buffer_set_limit(sb, 0);
+	ASSERT_EQ(storage_buffer_limit(sb), 32);
+	for (uint64_t i = 41; i <= 80; i++)
+		add_event(sb, 3000 + i, i);
+	ASSERT_EQ(storage_buffer_size(sb), 32);
+	
+	/* The governor's response keeps what fits the target */
+	storage_buffer_memory_respond(sb, MEMORY_PRESSURE_LOW, 1);
+	ASSERT_EQ(storage_buffer_size(sb), 32);
+	storage_buffer_memory_respond(sb, MEMORY_PRESSURE_HIGH, 1);
+	ASSERT_EQ(storage_buffer_size(sb), 1);
+	storage_buffer_memory_respond(sb, MEMORY_PRESSURE_NONE, 0);
+	ASSERT_EQ(storage_buffer_limit(sb), 32);
+	
+	storage_buffer_destroy(sb);
+}
+
+/* Checks that queried events come in order with their data */
+struct history_walk {
+	size_t count;
+	uint64_t last;
+	bool ordered;
+};
+
+static void walk_event(struct nlmon_event *event, void *ctx)
+{
+	struct history_walk *walk = ctx;
+	char expect[32] = { 0 };
+	
+	snprintf(expect, sizeof(expect), "payload %lu", (unsigned long)event->sequence);
+	if (event->sequence <= walk->last || event->data_size != sizeof(expect) ||
+	    memcmp(event->data, expect, sizeof(expect)) != 0 ||
+	    event->netlink.seq != (uint32_t)event->sequence)
+		walk->ordered = false;
+	walk->last = event->sequence;
+	walk->count++;
+}
+
+static void add_event_data(struct storage_buffer *sb, uint64_t timestamp, uint64_t sequence)
+{
+	struct nlmon_event event;
+	char payload[32];
+	
+	memset(&event, 0, sizeof(event));
+	memset(payload, 0, sizeof(payload));
+	snprintf(payload, sizeof(payload), "payload %lu", (unsigned long)sequence);
+	event.timestamp = timestamp;
+	event.sequence = sequence;
+	event.event_type = 1 + sequence % 2;
+	event.message_type = 16;
+	event.netlink.protocol = 0;
+	event.netlink.seq = (uint32_t)sequence;
+	snprintf(event.interface, sizeof(event.interface), "eth%lu", sequence % 4);
+	event.data = payload;
+	event.data_size = sizeof(payload);
+	storage_buffer_add(sb, &event);
+}
+
+TEST(storage_buffer_history)
+{
+	struct storage_buffer *sb = storage_buffer_create_indexed(64);
+	struct buffer_history_stats stats;
+	struct buffer_query_filter filter;
+	struct history_walk walk = { 0, 0, true };
+	size_t matched = 0;
+	
+	ASSERT_NOT_NULL(sb);
+	storage_buffer_set_history(sb, 1024 * 1024);
+	for (uint64_t i = 1; i <= 3064; i++)
+		add_event_data(sb, 5000 + i, i);
+	
+	/* Evicted events went into blocks far smaller than the events */
+	ASSERT_EQ(storage_buffer_size(sb), 64);
+	storage_buffer_history_stats(sb, &stats);
+	ASSERT_TRUE(stats.events >= 3000);
+	ASSERT_TRUE(stats.blocks > 0);
+	ASSERT_TRUE(stats.bytes < stats.raw_bytes);
+	ASSERT_TRUE(stats.bytes * 10 < stats.events * (sizeof(struct nlmon_event) + 32));
+	
+	/* Queries find every event once, history first */
+	ASSERT_EQ(storage_buffer_query(sb, NULL, walk_event, &walk), 3064);
+	ASSERT_EQ(walk.count, 3064);
+	ASSERT_EQ(walk.last, 3064);
+	ASSERT_TRUE(walk.ordered);
+	
+	/* Filters apply to the history too */
+	memset(&filter, 0, sizeof(filter));
+	filter.interface_pattern = "eth1";
+	filter.event_type = 2;
+	filter.start_time = 5101;
+	filter.end_time = 5200;
+	ASSERT_EQ(storage_buffer_query(sb, &filter, count_event, &matched), 25);
+	filter.max_results = 10;
+	ASSERT_EQ(storage_buffer_query(sb, &filter, count_event, &matched), 10);
+	
+	/* Over the budget the oldest blocks go, what is left still joins up */
+	storage_buffer_set_history(sb, stats.bytes / 2);
+	storage_buffer_history_stats(sb, &stats);
+	ASSERT_TRUE(stats.bytes <= stats.max_bytes);
+	memset(&walk, 0, sizeof(walk));
+	walk.ordered = true;
+	storage_buffer_query(sb, NULL, walk_event, &walk);
+	ASSERT_TRUE(walk.count < 3064);
+	ASSERT_TRUE(walk.count > 64);
+	ASSERT_EQ(walk.last, 3064);
+	ASSERT_TRUE(walk.ordered);
+	
+	storage_buffer_clear(sb);
+	storage_buffer_history_stats(sb, &stats);
+	ASSERT_EQ(stats.blocks, 0);
+	ASSERT_EQ(storage_buffer_query(sb, NULL, count_event, &matched), 0);
+	
+	storage_buffer_destroy(sb);
+}
+
+/* Events of the buffer an expression lets through */
+static size_t query_expr(struct storage_buffer *sb, const char *expression, bool *pushable)
+{
+	struct filter_expr *expr = filter_parse(expression);
+	struct buffer_query_filter filter = { 0 };
+	size_t count = 0;
+	
+	if (expr && expr->valid) {
+		filter.expr = expr->ast;
+		storage_buffer_query(sb, &filter, count_event, &count);
+		*pushable = storage_buffer_expr_pushable(expr->ast);
+	}
+	filter_expr_free(expr);
+	return count;
+}
+
+TEST(storage_buffer_expression_pushdown)
+{
+	struct storage_buffer *sb = storage_buffer_create_indexed(128);
+	struct buffer_event_header header = { .timestamp = 5, .event_type = 1, .interface = "eth2" };
+	struct filter_expr *expr;
+	bool pushable = false;
+	
+	ASSERT_NOT_NULL(sb);
+	for (uint64_t i = 1; i <= 100; i++)
+		add_event(sb, 1000 + i, i);
+	
+	/* Header columns decide the expression on the rows */
+	ASSERT_EQ(query_expr(sb, "interface == \"eth1\" AND timestamp > 1050", &pushable), 12);
+	ASSERT_TRUE(pushable);
+	ASSERT_EQ(query_expr(sb, "NOT sequence IN [1, 2, 3] AND 1010 >= timestamp", &pushable), 7);
+	ASSERT_TRUE(pushable);
+	ASSERT_EQ(query_expr(sb, "namespace == \"\" OR event_type == 2", &pushable), 100);
+	ASSERT_EQ(query_expr(sb, "event_type == \"1\"", &pushable), 0);
+	
+	/* Other fields pass rows on for the caller to evaluate */
+	ASSERT_EQ(query_expr(sb, "interface == \"eth3\" AND netlink.protocol == 0", &pushable), 25);
+	ASSERT_FALSE(pushable);
+	ASSERT_EQ(query_expr(sb, "interface =~ \"eth[12]\" OR sequence < 0", &pushable), 100);
+	ASSERT_FALSE(pushable);
+	
+	/* The same on a header */
+	expr = filter_parse("interface IN [\"eth1\", \"eth2\"] AND NOT event_type != 1");
+	ASSERT_TRUE(expr && expr->valid);
+	ASSERT_TRUE(storage_buffer_header_match(expr->ast, &header));
+	header.event_type = 2;
+	ASSERT_FALSE(storage_buffer_header_match(expr->ast, &header));
+	filter_expr_free(expr);
+	
+	storage_buffer_destroy(sb);
+}
+
+/* Writer and lock-free readers racing on a small buffer */
+#define RACE_CAPACITY 64
+#define RACE_EVENTS 500000
+#define RACE_READERS 3
+
+struct race {
+	struct storage_buffer *sb;
+	_Atomic bool writing;
+	_Atomic unsigned long reads;        /* Reads overlapping the writer */
+	_Atomic unsigned long torn;         /* Reads mixing two events */
+};
+
+static bool header_consistent(const struct buffer_event_header *header)
+{
+	char name[16] = { 0 };
+	
+	snprintf(name, sizeof(name), "eth%lu", (unsigned long)(header->sequence % 4));
+	return header->timestamp == header->sequence * 10 &&
+	       header->event_type == 1 + header->sequence % 2 &&
+	       memcmp(header->interface, name, sizeof(name)) == 0;
+}
+
+/* Also reads the data, which must not have been released yet */
+static bool event_consistent(const struct nlmon_event *event)
+{
+	struct buffer_event_header header;
+	char expect[32] = { 0 };
+	
+	header.timestamp = event->timestamp;
+	header.sequence = event->sequence;
+	header.event_type = event->event_type;
+	memcpy(header.interface, event->interface, sizeof(header.interface));
+	snprintf(expect, sizeof(expect), "payload %lu", (unsigned long)event->sequence);
+	return header_consistent(&header) && event->netlink.seq == (uint32_t)event->sequence &&
+	       event->data_size == sizeof(expect) && memcmp(event->data, expect, sizeof(expect)) == 0;
+}
+
+static void race_event(struct nlmon_event *event, void *ctx)
+{
+	struct race *race = ctx;
+	
+	if (!event_consistent(event))
+		atomic_fetch_add(&race->torn, 1);
+}
+
+static void *race_writer(void *arg)
+{
+	struct race *race = arg;
+	
+	for (uint64_t seq = 1; seq <= RACE_EVENTS; seq++)
+		add_event_data(race->sb, seq * 10, seq);
+	atomic_store(&race->writing, false);
+	return NULL;
+}
+
+static void *race_reader(void *arg)
+{
+	struct race *race = arg;
+	struct buffer_event_header headers[RACE_CAPACITY];
+	struct nlmon_event *event;
+	size_t count;
+	
+	while (atomic_load(&race->writing)) {
+		/* Seqlock path, headers copied out of the columns */
+		count = storage_buffer_get_headers(race->sb, RACE_CAPACITY, headers);
+		for (size_t i = 0; i < count; i++) {
+			if (!header_consistent(&headers[i]) ||
+			    (i > 0 && headers[i].sequence >= headers[i - 1].sequence))
+				atomic_fetch_add(&race->torn, 1);
+		}
+		
+		/* Events used inside a read side section while being evicted */
+		storage_buffer_query(race->sb, NULL, race_event, race);
+		
+		/* References outlive eviction */
+		event = storage_buffer_get_ref(race->sb, 0);
+		if (event) {
+			if (!event_consistent(event))
+				atomic_fetch_add(&race->torn, 1);
+			nlmon_event_put(event);
+		}
+		
+		atomic_fetch_add(&race->reads, 1);
+	}
+	return NULL;
+}
+
+TEST(storage_buffer_concurrent_readers)
+{
+	struct race race = { 0 };
+	struct buffer_event_header header;
+	pthread_t writer, readers[RACE_READERS];
+	
+	race.sb = storage_buffer_create_indexed(RACE_CAPACITY);
+	ASSERT_NOT_NULL(race.sb);
+	atomic_store(&race.writing, true);
+	
+	for (int i = 0; i < RACE_READERS; i++)
+		pthread_create(&readers[i], NULL, race_reader, &race);
+	pthread_create(&writer, NULL, race_writer, &race);
+	pthread_join(writer, NULL);
+	for (int i = 0; i < RACE_READERS; i++)
+		pthread_join(readers[i], NULL);
+	
+	ASSERT_EQ(atomic_load(&race.torn), 0);
+	ASSERT_TRUE(atomic_load(&race.reads) > 0);
+	
+	/* The writer never waited on the readers and got everything in */
+	ASSERT_EQ(storage_buffer_get_headers(race.sb, 1, &header), 1);
+	ASSERT_EQ(header.sequence, RACE_EVENTS);
+	storage_buffer_destroy(race.sb);
+}
+
+TEST_SUITE_BEGIN("Storage Buffer")
+	RUN_TEST(storage_buffer_keyset_pages);
+	RUN_TEST(storage_buffer_keyset_evicted);
+	RUN_TEST(storage_buffer_limit_under_pressure);
+	RUN_TEST(storage_buffer_history);
+	RUN_TEST(storage_buffer_expression_pushdown);
+	RUN_TEST(storage_buffer_concurrent_readers);
+TEST_SUITE_END()
@@ -0,0 +1,261 @@
+/* test_storage_db.c - Unit tests for database queries */
+
+#include "test_framework.h"
+#include "storage_db.h"
+#include "filter_parser.h"
+#include "event_processor.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_DB_PATH "/tmp/test_unit_storage_db.db"
+#define TEST_EVENTS 2000
+
+static struct storage_db *open_test_db(uint64_t partition_span)
+{
+	struct storage_db_config config = {
+		.db_path = TEST_DB_PATH,
+		.partition_span = partition_span,
+	};
+	struct storage_db *db;
+	
+	unlink(TEST_DB_PATH);
+	db = storage_db_open(&config);
+	if (!db)
+		return NULL;
+	
+	for (int i = 0; i < TEST_EVENTS; i++) {
+		struct nlmon_event event = {0};
+		
+		event.timestamp = i;
+		event.event_type = i % 4;
+		snprintf(event.interface, sizeof(event.interface), "eth%d", i % 5);
+		storage_db_insert(db, &event);
+	}
+	storage_db_flush(db);
+	storage_db_analyze(db);
+	
+	return db;
+}
+
+static void close_test_db(struct storage_db *db)
+{
+	storage_db_close(db);
+	unlink(TEST_DB_PATH);
+}
+
+static void count_callback(struct nlmon_event *event, void *ctx)
+{
+	(void)event;
+	(*(int *)ctx)++;
+}
+
+struct order_check {
+	uint64_t last;
+	int out_of_order;
+};
+
+static void order_callback(struct nlmon_event *event, void *ctx)
+{
+	struct order_check *check = ctx;
+	
+	if (event->timestamp < check->last)
+		check->out_of_order++;
+	check->last = event->timestamp;
+}
+
+TEST(storage_db_explain_uses_indexes)
+{
+	struct storage_db *db = open_test_db(0);
+	struct db_query_filter by_type = { .event_type = 2, .start_time = 100, .limit = 10 };
+	struct db_query_filter by_interface = { .interface_pattern = "eth3", .limit = 10 };
+	struct db_query_filter by_time = { .start_time = 1000, .descending = true };
+	char plan[1024];
+	
+	ASSERT_NOT_NULL(db);
+	
+	ASSERT_TRUE(storage_db_explain(db, &by_type, plan, sizeof(plan)) > 0);
+	ASSERT_NOT_NULL(strstr(plan, "idx_event_type_timestamp"));
+	ASSERT_NULL(strstr(plan, "TEMP B-TREE"));
+	
+	ASSERT_TRUE(storage_db_explain(db, &by_interface, plan, sizeof(plan)) > 0);
+	ASSERT_NOT_NULL(strstr(plan, "idx_interface_timestamp"));
+	ASSERT_NULL(strstr(plan, "TEMP B-TREE"));
+	
+	ASSERT_TRUE(storage_db_explain(db, &by_time, plan, sizeof(plan)) > 0);
+	ASSERT_NOT_NULL(strstr(plan, "idx_timestamp"));
+	ASSERT_NULL(strstr(plan, "TEMP B-TREE"));
+	
+	close_test_db(db);
+}
+
+TEST(storage_db_keyset_pagination)
+{
+	struct storage_db *db = open_test_db(0);
+	struct db_query_filter filter = { .event_type = 1, .limit = 128 };
+	struct db_query_filter all = { .event_type = 1 };
+	struct order_check check = {0};
+	int total = 0, pages = 0, n;
+	
+	ASSERT_NOT_NULL(db);
+	
+	/* Each page resumes after the last event of the one before */
+	while ((n = storage_db_query(db, &filter, order_callback, &check)) > 0) {
+		ASSERT_TRUE(n <= 128);
+		total += n;
+		pages++;
+		filter.after_cursor = true;
+	}
+	
+	ASSERT_EQ(n, 0);
+	ASSERT_EQ(check.out_of_order, 0);
+	ASSERT_EQ(total, storage_db_count(db, &all));
+	ASSERT_EQ(pages, (TEST_EVENTS / 4 + 127) / 128);
+	
+	close_test_db(db);
+}
+
+TEST(storage_db_keyset_partitions)
+{
+	struct storage_db *db = open_test_db(300);
+	struct db_query_filter filter = { .limit = 100, .descending = true };
+	int total = 0, n, count = 0;
+	
+	ASSERT_NOT_NULL(db);
+	
+	while ((n = storage_db_query(db, &filter, count_callback, &count)) > 0) {
+		total += n;
+		filter.after_cursor = true;
+	}
+	
+	ASSERT_EQ(total, TEST_EVENTS);
+	ASSERT_EQ(count, TEST_EVENTS);
+	
+	close_test_db(db);
+}
+
+TEST(storage_db_interface_patterns)
+{
+	struct storage_db *db = open_test_db(0);
+	struct db_query_filter exact = { .interface_pattern = "eth3" };
+	struct db_query_filter prefix = { .interface_pattern = "eth%" };
+	struct db_query_filter suffix = { .interface_pattern = "%3" };
+	struct db_query_filter bad_order = { .order_by = "timestamp; DROP TABLE events" };
+	int count = 0;
+	
+	ASSERT_NOT_NULL(db);
+	
+	ASSERT_EQ(storage_db_count(db, &exact), TEST_EVENTS / 5);
+	ASSERT_EQ(storage_db_count(db, &prefix), TEST_EVENTS);
+	ASSERT_EQ(storage_db_count(db, &suffix), TEST_EVENTS / 5);
+	ASSERT_EQ(storage_db_query(db, &bad_order, count_callback, &count), -1);
+	ASSERT_EQ(storage_db_count(db, NULL), TEST_EVENTS);
+	
+	close_test_db(db);
+}
+
+/* Events a filter expression fetches, -1 on error; pushable tells if it was decided */
+static int count_expr(struct storage_db *db, const char *expression, uint64_t start_time,
+                      bool *pushable)
+{
+	struct filter_expr *expr = filter_parse(expression);
+	struct db_query_filter filter = { .start_time = start_time };
+	int count = -1;
+	
+	if (expr && expr->valid) {
+		filter.expr = expr->ast;
+		count = storage_db_count(db, &filter);
+		*pushable = storage_db_expr_pushable(expr->ast);
+	}
+	filter_expr_free(expr);
+	return count;
+}
+
+TEST(storage_db_expression_pushdown)
+{
+	struct storage_db *db = open_test_db(500);
+	bool pushable = false;
+	
+	ASSERT_NOT_NULL(db);
+	
+	/* Stored columns, decided by the query alone */
+	ASSERT_EQ(count_expr(db, "event_type == 2 AND interface == \"eth3\"", 0, &pushable), 100);
+	ASSERT_TRUE(pushable);
+	ASSERT_EQ(count_expr(db, "interface IN [\"eth1\", \"eth2\", 7] AND NOT timestamp < 1000",
+	                     0, &pushable), 400);
+	ASSERT_TRUE(pushable);
+	ASSERT_EQ(count_expr(db, "1500 <= timestamp OR event_type == 0", 0, &pushable), 875);
+	ASSERT_TRUE(pushable);
+	
+	/* Mismatched types never match, as in filter_eval() */
+	ASSERT_EQ(count_expr(db, "interface == 3", 0, &pushable), 0);
+	ASSERT_TRUE(pushable);
+	ASSERT_EQ(count_expr(db, "NOT interface == 3", 0, &pushable), TEST_EVENTS);
+	
+	/* Other fields narrow nothing, an AND still pushes its stored side */
+	ASSERT_EQ(count_expr(db, "event_type == 1 AND netlink.protocol == 0", 0, &pushable), 500);
+	ASSERT_FALSE(pushable);
+	ASSERT_EQ(count_expr(db, "event_type == 1 OR netlink.protocol == 0", 0, &pushable), TEST_EVENTS);
+	ASSERT_FALSE(pushable);
+	ASSERT_EQ(count_expr(db, "NOT (event_type == 1 AND netlink.protocol == 0)", 0, &pushable),
+	          TEST_EVENTS);
+	ASSERT_EQ(count_expr(db, "interface =~ \"eth[12]\"", 0, &pushable), TEST_EVENTS);
+	ASSERT_FALSE(pushable);
+	
+	/* Combined with the fixed fields */
+	ASSERT_EQ(count_expr(db, "event_type IN [1, 3]", 1000, &pushable), 500);
+	
+	close_test_db(db);
+}
+
+TEST(storage_db_maintenance_steps)
+{
+	struct storage_db_config config = {
+		.db_path = TEST_DB_PATH,
+		.partition_span = 1000,
+		.enable_wal = true,
+		.wal_autocheckpoint = -1,
+	};
+	struct storage_db *db;
+	char data[256];
+	int wal_frames = 0, checkpointed = 0;
+	int pages;
+	
+	unlink(TEST_DB_PATH);
+	db = storage_db_open(&config);
+	ASSERT_NOT_NULL(db);
+	
+	memset(data, 'x', sizeof(data));
+	for (int i = 0; i < TEST_EVENTS; i++) {
+		struct nlmon_event event = {0};
+		
+		event.timestamp = i;
+		event.data = data;
+		event.data_size = sizeof(data);
+		storage_db_insert(db, &event);
+	}
+	ASSERT_TRUE(storage_db_flush(db));
+	
+	/* Without automatic checkpoints the WAL holds every commit */
+	ASSERT_TRUE(storage_db_wal_checkpoint(db, &wal_frames, &checkpointed));
+	ASSERT_TRUE(wal_frames > 0);
+	ASSERT_EQ(checkpointed, wal_frames);
+	
+	/* Deleting rows of a partition leaves its pages on the free list */
+	ASSERT_EQ(storage_db_delete_before(db, 900), 900);
+	ASSERT_EQ(storage_db_incremental_vacuum(db, 4), 4);
+	pages = storage_db_incremental_vacuum(db, 0);
+	ASSERT_TRUE(pages > 4);
+	ASSERT_EQ(storage_db_incremental_vacuum(db, 0), 0);
+	
+	close_test_db(db);
+}
+
+TEST_SUITE_BEGIN("Storage Database")
+	RUN_TEST(storage_db_explain_uses_indexes);
+	RUN_TEST(storage_db_keyset_pagination);
+	RUN_TEST(storage_db_keyset_partitions);
+	RUN_TEST(storage_db_interface_patterns);
+	RUN_TEST(storage_db_expression_pushdown);
+	RUN_TEST(storage_db_maintenance_steps);
+TEST_SUITE_END()
@@ -0,0 +1,200 @@
+/* test_storage_layer.c - Unit tests for the storage layer pipeline */
+
+#include "test_framework.h"
+#include "storage_layer.h"
+#include "event_processor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_DB_PATH "/tmp/test_unit_storage_layer.db"
+#define TEST_AUDIT_PATH "/tmp/test_unit_storage_layer.log"
+
+static void remove_files(void)
+{
+	unlink(TEST_DB_PATH);
+	unlink(TEST_DB_PATH "-wal");
+	unlink(TEST_DB_PATH "-shm");
+	unlink(TEST_AUDIT_PATH);
+}
+
+static struct storage_layer *open_layer(bool pipelined, size_t queue_size)
+{
+	struct storage_layer_config config = {
+		.enable_buffer = true,
+		.buffer_capacity = 4096,
+		.enable_database = true,
+		.db_path = TEST_DB_PATH,
+		.db_batch_size = 100,
+		.enable_audit_log = true,
+		.audit_log_path = TEST_AUDIT_PATH,
+		.audit_batch_size = 32,
+		.pipelined = pipelined,
+		.pipeline_queue_size = queue_size,
+	};
+	
+	remove_files();
+	return storage_layer_create(&config);
+}
+
+static bool store_events(struct storage_layer *sl, uint64_t first, uint64_t count)
+{
+	for (uint64_t i = first; i < first + count; i++) {
+		struct nlmon_event event;
+		
+		memset(&event, 0, sizeof(event));
+		event.timestamp = 1000 + i;
+		event.sequence = i;
+		event.event_type = 1;
+		snprintf(event.interface, sizeof(event.interface), "eth%lu", (unsigned long)(i % 3));
+		if (!storage_layer_store_event(sl, &event, i % 10 == 0))
+			return false;
+	}
+	
+	return true;
+}
+
+static uint64_t db_events(struct storage_layer *sl)
+{
+	uint64_t count = 0;
+	
+	storage_layer_get_stats(sl, NULL, NULL, &count, NULL, NULL);
+	return count;
+}
+
+TEST(pipelined_events_become_durable)
+{
+	struct storage_layer *sl = open_layer(true, 0);
+	struct storage_stage_stats stats[4];
+	size_t size = 0;
+	
+	ASSERT_NOT_NULL(sl);
+	ASSERT_TRUE(store_events(sl, 1, 1000));
+	ASSERT_EQ(storage_layer_sequence(sl), 1000);
+	
+	/* The buffer is written before store returns */
+	storage_layer_get_stats(sl, &size, NULL, NULL, NULL, NULL);
+	ASSERT_EQ(size, 1000);
+	
+	ASSERT_TRUE(storage_layer_wait_durable(sl, 1000, 10000));
+	ASSERT_TRUE(storage_layer_durable_sequence(sl) >= 1000);
+	ASSERT_EQ(db_events(sl), 1000);
+	
+	ASSERT_EQ(storage_layer_get_stage_stats(sl, stats, 4), 2);
+	ASSERT_STR_EQ(stats[0].name, "database");
+	ASSERT_STR_EQ(stats[1].name, "audit");
+	for (int i = 0; i < 2; i++) {
+		ASSERT_EQ(stats[i].written, 1000);
+		ASSERT_EQ(stats[i].failed, 0);
+		ASSERT_EQ(stats[i].durable, 1000);
+		ASSERT_TRUE(stats[i].flushes > 0);
+		ASSERT_TRUE(stats[i].flushes <= 1000);
+	}
+	
+	/* Already durable, no wait */
+	ASSERT_TRUE(storage_layer_wait_durable(sl, 10, 0));
+	
+	storage_layer_destroy(sl);
+	remove_files();
+}
+
+TEST(full_stage_queues_hold_the_caller)
+{
+	struct storage_layer *sl = open_layer(true, 4);
+	
+	ASSERT_NOT_NULL(sl);
+	ASSERT_TRUE(store_events(sl, 1, 500));
+	ASSERT_TRUE(storage_layer_flush(sl));
+	
+	/* Nothing is dropped with the queue full, the caller waits instead */
+	ASSERT_EQ(storage_layer_durable_sequence(sl), 500);
+	ASSERT_EQ(db_events(sl), 500);
+	
+	storage_layer_destroy(sl);
+	remove_files();
+}
+
+TEST(destroy_drains_the_stages)
+{
+	struct storage_layer_config config = {
+		.enable_database = true,
+		.db_path = TEST_DB_PATH,
+	};
+	struct storage_layer *sl = open_layer(true, 0);
+	
+	ASSERT_NOT_NULL(sl);
+	ASSERT_TRUE(store_events(sl, 1, 300));
+	storage_layer_destroy(sl);
+	
+	/* Reopened without a pipeline, every event made it */
+	sl = storage_layer_create(&config);
+	ASSERT_NOT_NULL(sl);
+	ASSERT_EQ(db_events(sl), 300);
+	
+	storage_layer_destroy(sl);
+	remove_files();
+}
+
+TEST(synchronous_layer_sequences)
+{
+	struct storage_layer *sl = open_layer(false, 0);
+	
+	ASSERT_NOT_NULL(sl);
+	ASSERT_TRUE(store_events(sl, 1, 50));
+	ASSERT_EQ(storage_layer_sequence(sl), 50);
+	ASSERT_EQ(storage_layer_get_stage_stats(sl, NULL, 0), 0);
+	
+	/* Waiting flushes on the caller */
+	ASSERT_TRUE(storage_layer_durable_sequence(sl) < 50);
+	ASSERT_TRUE(storage_layer_wait_durable(sl, 50, 0));
+	ASSERT_EQ(storage_layer_durable_sequence(sl), 50);
+	ASSERT_EQ(db_events(sl), 50);
+	
+	storage_layer_destroy(sl);
+	remove_files();
+}
+
+TEST(database_stage_samples)
+{
+	struct storage_layer_config config = {
+		.enable_buffer = true,
+		.buffer_capacity = 4096,
+		.enable_database = true,
+		.db_path = TEST_DB_PATH,
+		.db_sampling = { .fallback = { .mode = EVENT_SAMPLER_FIXED, .rate = 10 } },
+		.enable_audit_log = true,
+		.audit_log_path = TEST_AUDIT_PATH,
+		.pipelined = true,
+	};
+	struct storage_stage_stats stats[2];
+	struct storage_layer *sl;
+	size_t size = 0;
+	
+	remove_files();
+	sl = storage_layer_create(&config);
+	ASSERT_NOT_NULL(sl);
+	ASSERT_TRUE(store_events(sl, 1, 1000));
+	ASSERT_TRUE(storage_layer_wait_durable(sl, 1000, 10000));
+	
+	/* The database keeps 1 in 10, the buffer and audit log everything */
+	ASSERT_EQ(db_events(sl), 100);
+	storage_layer_get_stats(sl, &size, NULL, NULL, NULL, NULL);
+	ASSERT_EQ(size, 1000);
+	ASSERT_EQ(storage_layer_get_stage_stats(sl, stats, 2), 2);
+	ASSERT_EQ(stats[0].written, 100);
+	ASSERT_EQ(stats[0].sampled, 900);
+	ASSERT_EQ(stats[1].written, 1000);
+	ASSERT_EQ(stats[1].sampled, 0);
+	
+	storage_layer_destroy(sl);
+	remove_files();
+}
+
+TEST_SUITE_BEGIN("Storage Layer")
+	RUN_TEST(pipelined_events_become_durable);
+	RUN_TEST(full_stage_queues_hold_the_caller);
+	RUN_TEST(destroy_drains_the_stages);
+	RUN_TEST(synchronous_layer_sequences);
+	RUN_TEST(database_stage_samples);
+TEST_SUITE_END()
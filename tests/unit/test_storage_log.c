@@ -0,0 +1,255 @@
+/* test_storage_log.c - Unit tests for the segment log */
+
+#include "test_framework.h"
+#include "storage_log.h"
+#include "event_processor.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_LOG_DIR "/tmp/test_unit_storage_log"
+
+static void remove_log_dir(void)
+{
+	struct dirent *entry;
+	char path[512];
+	DIR *dir;
+	
+	dir = opendir(TEST_LOG_DIR);
+	if (!dir)
+		return;
+	
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", TEST_LOG_DIR, entry->d_name);
+		unlink(path);
+	}
+	
+	closedir(dir);
+	rmdir(TEST_LOG_DIR);
+}
+
+static struct storage_log *open_test_log(size_t segment_size, size_t max_segments)
+{
+	struct storage_log_config config = {
+		.dir = TEST_LOG_DIR,
+		.segment_size = segment_size,
+		.max_segments = max_segments,
+		.index_interval = 16,
+	};
+	
+	return storage_log_open(&config);
+}
+
+static bool append_events(struct storage_log *log, uint64_t first, int count)
+{
+	char data[64];
+	
+	for (int i = 0; i < count; i++) {
+		struct nlmon_event event = {0};
+		
+		event.timestamp = first + i;
+		event.sequence = first + i;
+		event.event_type = 1;
+		snprintf(event.interface, sizeof(event.interface), "eth%d", i % 3);
+		snprintf(data, sizeof(data), "event %06llu", (unsigned long long)(first + i));
+		event.data = data;
+		event.data_size = strlen(data) + 1;
+		
+		if (!storage_log_append(log, &event))
+			return false;
+	}
+	
+	return true;
+}
+
+/* Records the cursor returns, -1 if one is out of order or damaged */
+static int read_all(struct storage_log *log, uint64_t start, uint64_t end)
+{
+	struct storage_log_cursor *cursor = storage_log_cursor_open(log, start, end);
+	const struct storage_log_record *record;
+	uint64_t last = 0;
+	int count = 0;
+	char data[64];
+	
+	if (!cursor)
+		return -1;
+	
+	while ((record = storage_log_cursor_next(cursor)) != NULL) {
+		snprintf(data, sizeof(data), "event %06llu", (unsigned long long)record->timestamp);
+		if (record->timestamp < last || record->sequence != record->timestamp ||
+		    strcmp(storage_log_record_data(record), data) != 0) {
+			count = -1;
+			break;
+		}
+		last = record->timestamp;
+		count++;
+	}
+	
+	storage_log_cursor_close(cursor);
+	return count;
+}
+
+TEST(storage_log_append_read)
+{
+	struct storage_log *log;
+	struct storage_log_stats stats;
+	
+	remove_log_dir();
+	log = open_test_log(0, 0);
+	ASSERT_NOT_NULL(log);
+	
+	ASSERT_TRUE(append_events(log, 1, 1000));
+	ASSERT_EQ(read_all(log, 0, 0), 1000);
+	ASSERT_EQ(read_all(log, 101, 200), 100);
+	ASSERT_EQ(read_all(log, 2000, 0), 0);
+	
+	ASSERT_TRUE(storage_log_get_stats(log, &stats));
+	ASSERT_EQ(stats.records, 1000);
+	ASSERT_EQ(stats.appended, 1000);
+	ASSERT_EQ(stats.segments, 1);
+	
+	storage_log_close(log);
+	remove_log_dir();
+}
+
+TEST(storage_log_cursor_follows_appends)
+{
+	struct storage_log *log;
+	struct storage_log_cursor *cursor;
+	const struct storage_log_record *record;
+	int count = 0;
+	
+	remove_log_dir();
+	log = open_test_log(64 * 1024, 0);
+	ASSERT_NOT_NULL(log);
+	
+	cursor = storage_log_cursor_open(log, 0, 0);
+	ASSERT_NOT_NULL(cursor);
+	ASSERT_NULL(storage_log_cursor_next(cursor));
+	
+	/* Enough to roll over several segments */
+	ASSERT_TRUE(append_events(log, 1, 5000));
+	while ((record = storage_log_cursor_next(cursor)) != NULL)
+		count++;
+	ASSERT_EQ(count, 5000);
+	
+	ASSERT_TRUE(append_events(log, 5001, 10));
+	while ((record = storage_log_cursor_next(cursor)) != NULL)
+		count++;
+	ASSERT_EQ(count, 5010);
+	
+	storage_log_cursor_close(cursor);
+	storage_log_close(log);
+	remove_log_dir();
+}
+
+TEST(storage_log_reopen_recovers)
+{
+	struct storage_log *log;
+	struct storage_log_stats stats;
+	
+	remove_log_dir();
+	log = open_test_log(64 * 1024, 0);
+	ASSERT_NOT_NULL(log);
+	ASSERT_TRUE(append_events(log, 1, 3000));
+	storage_log_close(log);
+	
+	/* Sealed segments load their index, the open one is scanned */
+	log = open_test_log(64 * 1024, 0);
+	ASSERT_NOT_NULL(log);
+	ASSERT_TRUE(storage_log_get_stats(log, &stats));
+	ASSERT_EQ(stats.records, 3000);
+	ASSERT_TRUE(stats.recovered > 0);
+	ASSERT_EQ(read_all(log, 0, 0), 3000);
+	ASSERT_EQ(read_all(log, 1500, 1599), 100);
+	
+	ASSERT_TRUE(append_events(log, 3001, 100));
+	ASSERT_EQ(read_all(log, 0, 0), 3100);
+	
+	storage_log_close(log);
+	remove_log_dir();
+}
+
+TEST(storage_log_crc_stops_recovery)
+{
+	struct storage_log *log;
+	struct storage_log_stats stats;
+	char path[512];
+	off_t offset;
+	int fd;
+	
+	remove_log_dir();
+	log = open_test_log(0, 0);
+	ASSERT_NOT_NULL(log);
+	ASSERT_TRUE(append_events(log, 1, 100));
+	storage_log_close(log);
+	
+	/* Damage the data of the 50th record, all records have the same size */
+	snprintf(path, sizeof(path), "%s/%016x.seg", TEST_LOG_DIR, 0);
+	fd = open(path, O_RDWR);
+	ASSERT_TRUE(fd >= 0);
+	offset = 64 + 49 * 64 + sizeof(struct storage_log_record);
+	ASSERT_EQ(pwrite(fd, "X", 1, offset), 1);
+	close(fd);
+	
+	log = open_test_log(0, 0);
+	ASSERT_NOT_NULL(log);
+	ASSERT_TRUE(storage_log_get_stats(log, &stats));
+	ASSERT_EQ(stats.records, 49);
+	ASSERT_EQ(read_all(log, 0, 0), 49);
+	
+	storage_log_close(log);
+	remove_log_dir();
+}
+
+TEST(storage_log_retention)
+{
+	struct storage_log *log;
+	struct storage_log_stats stats;
+	int deleted;
+	
+	remove_log_dir();
+	log = open_test_log(64 * 1024, 0);
+	ASSERT_NOT_NULL(log);
+	ASSERT_TRUE(append_events(log, 1, 5000));
+	
+	ASSERT_TRUE(storage_log_get_stats(log, &stats));
+	ASSERT_TRUE(stats.segments > 2);
+	
+	/* Only whole segments before the timestamp go */
+	deleted = storage_log_delete_before(log, 2500);
+	ASSERT_TRUE(deleted > 0 && deleted < 2500);
+	ASSERT_EQ(read_all(log, 0, 0), 5000 - deleted);
+	ASSERT_EQ(read_all(log, 2500, 0), 2501);
+	
+	/* The active segment is never deleted */
+	storage_log_delete_before(log, 10000);
+	ASSERT_TRUE(storage_log_get_stats(log, &stats));
+	ASSERT_EQ(stats.segments, 1);
+	
+	storage_log_close(log);
+	
+	/* Segment count limit */
+	log = open_test_log(64 * 1024, 2);
+	ASSERT_NOT_NULL(log);
+	ASSERT_TRUE(append_events(log, 5001, 5000));
+	ASSERT_TRUE(storage_log_get_stats(log, &stats));
+	ASSERT_EQ(stats.segments, 2);
+	ASSERT_EQ(read_all(log, 0, 0), (int)stats.records);
+	
+	storage_log_close(log);
+	remove_log_dir();
+}
+
+TEST_SUITE_BEGIN("Storage Segment Log")
+	RUN_TEST(storage_log_append_read);
+	RUN_TEST(storage_log_cursor_follows_appends);
+	RUN_TEST(storage_log_reopen_recovers);
+	RUN_TEST(storage_log_crc_stops_recovery);
+	RUN_TEST(storage_log_retention);
+TEST_SUITE_END()
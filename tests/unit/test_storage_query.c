@@ -0,0 +1,227 @@
+/* test_storage_query.c - Unit tests for the parallel scan query engine */
+
+#include "test_framework.h"
+#include "storage_query.h"
+#include "storage_log.h"
+#include "storage_buffer.h"
+#include "event_processor.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_LOG_DIR "/tmp/test_unit_storage_query"
+#define SEC 1000000000ULL
+#define EVENTS 6000
+
+static void remove_log_dir(void)
+{
+	struct dirent *entry;
+	char path[512];
+	DIR *dir;
+	
+	dir = opendir(TEST_LOG_DIR);
+	if (!dir)
+		return;
+	
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", TEST_LOG_DIR, entry->d_name);
+		unlink(path);
+	}
+	
+	closedir(dir);
+	rmdir(TEST_LOG_DIR);
+}
+
+/* Event i: a second apart, half on eth0, a quarter each on eth1 and eth2 */
+static void make_event(struct nlmon_event *event, int i, char *data, size_t size)
+{
+	static const char *const interfaces[] = { "eth0", "eth0", "eth1", "eth2" };
+	
+	memset(event, 0, sizeof(*event));
+	event->timestamp = (uint64_t)(i + 1) * SEC;
+	event->sequence = (uint64_t)i + 1;
+	event->event_type = 1 + i % 3;
+	event->message_type = 16;
+	snprintf(event->interface, sizeof(event->interface), "%s", interfaces[i % 4]);
+	snprintf(data, size, "event %06d with some payload", i);
+	event->data = data;
+	event->data_size = strlen(data) + 1;
+}
+
+/* Log of EVENTS events over several small segments */
+static struct storage_log *open_test_log(void)
+{
+	struct storage_log_config config = {
+		.dir = TEST_LOG_DIR,
+		.segment_size = 64 * 1024,
+		.index_interval = 16,
+	};
+	struct storage_log *log;
+	char data[64];
+	
+	remove_log_dir();
+	log = storage_log_open(&config);
+	if (!log)
+		return NULL;
+	
+	for (int i = 0; i < EVENTS; i++) {
+		struct nlmon_event event;
+	
+		make_event(&event, i, data, sizeof(data));
+		if (!storage_log_append(log, &event)) {
+			storage_log_close(log);
+			return NULL;
+		}
+	}
+	return log;
+}
+
+TEST(storage_query_group_top_k)
+{
+	struct storage_log *log = open_test_log();
+	struct storage_query query = { .threads = 4 };
+	struct storage_query_result result;
+	
+	ASSERT_NOT_NULL(log);
+	
+	/* Every segment is a partition, the groups add up across them */
+	ASSERT_TRUE(storage_query_parse_columns("interface", &query.group_by));
+	query.top_k = 2;
+	ASSERT_EQ(storage_query_run(log, NULL, &query, &result), QUERY_OK);
+	ASSERT_TRUE(result.partitions > 1);
+	ASSERT_EQ(result.scanned, EVENTS);
+	ASSERT_EQ(result.matched, EVENTS);
+	ASSERT_EQ(result.num_rows, 2);
+	ASSERT_TRUE(result.truncated);
+	ASSERT_STR_EQ(result.rows[0].interface, "eth0");
+	ASSERT_EQ(result.rows[0].count, EVENTS / 2);
+	ASSERT_STR_EQ(result.rows[1].interface, "eth1");
+	ASSERT_EQ(result.rows[1].count, EVENTS / 4);
+	ASSERT_EQ(result.rows[0].timestamp, 0);
+	storage_query_result_free(&result);
+	
+	/* Filtered, per event type in buckets of 1000 seconds, on one thread */
+	query.filter = "interface == \"eth0\"";
+	query.threads = 1;
+	query.top_k = 0;
+	query.bucket_ns = 1000 * SEC;
+	ASSERT_TRUE(storage_query_parse_columns("timestamp,event_type", &query.group_by));
+	ASSERT_EQ(storage_query_run(log, NULL, &query, &result), QUERY_OK);
+	ASSERT_EQ(result.matched, EVENTS / 2);
+	ASSERT_EQ(result.num_rows, 6 * 3);
+	ASSERT_FALSE(result.truncated);
+	for (size_t i = 0; i < result.num_rows; i++) {
+		ASSERT_EQ(result.rows[i].timestamp % (1000 * SEC), 0);
+		ASSERT_STR_EQ(result.rows[i].interface, "");
+	}
+	storage_query_result_free(&result);
+	
+	storage_log_close(log);
+	remove_log_dir();
+}
+
+TEST(storage_query_listing)
+{
+	struct storage_log *log = open_test_log();
+	struct storage_query query = {
+		.filter = "event_type == 2 AND interface == \"eth1\"",
+		.start_time = 1001 * SEC,
+		.end_time = 3000 * SEC,
+		.limit = 50,
+	};
+	struct storage_query_result result;
+	
+	ASSERT_NOT_NULL(log);
+	
+	/* Rows in timestamp order across the segments, cut at the limit */
+	ASSERT_EQ(storage_query_run(log, NULL, &query, &result), QUERY_OK);
+	ASSERT_EQ(result.num_rows, 50);
+	ASSERT_TRUE(result.truncated);
+	for (size_t i = 0; i < result.num_rows; i++) {
+		ASSERT_EQ(result.rows[i].event_type, 2);
+		ASSERT_STR_EQ(result.rows[i].interface, "eth1");
+		ASSERT_TRUE(result.rows[i].timestamp >= 1001 * SEC);
+		if (i > 0)
+			ASSERT_TRUE(result.rows[i].timestamp > result.rows[i - 1].timestamp);
+	}
+	storage_query_result_free(&result);
+	
+	/* Event i is type 2 on eth1 for i = 10 mod 12, 167 of them in the range */
+	query.limit = 1000;
+	ASSERT_EQ(storage_query_run(log, NULL, &query, &result), QUERY_OK);
+	ASSERT_EQ(result.num_rows, 167);
+	ASSERT_FALSE(result.truncated);
+	storage_query_result_free(&result);
+	
+	storage_log_close(log);
+	remove_log_dir();
+}
+
+TEST(storage_query_limits)
+{
+	struct storage_log *log = open_test_log();
+	struct storage_query query = { .filter = "interface ==" };
+	struct storage_query_result result;
+	uint32_t mask;
+	
+	ASSERT_NOT_NULL(log);
+	
+	ASSERT_EQ(storage_query_run(log, NULL, &query, &result), QUERY_INVALID);
+	ASSERT_TRUE(result.error[0] != '\0');
+	ASSERT_FALSE(storage_query_parse_columns("interface,bogus", &mask));
+	
+	/* A group per sequence number does not fit in 64KB */
+	query.filter = NULL;
+	query.group_by = QUERY_COL_BIT(QUERY_COL_SEQUENCE);
+	query.max_memory = 64 * 1024;
+	ASSERT_EQ(storage_query_run(log, NULL, &query, &result), QUERY_MEMORY);
+	ASSERT_NULL(result.rows);
+	ASSERT_EQ(result.num_rows, 0);
+	
+	storage_log_close(log);
+	remove_log_dir();
+}
+
+TEST(storage_query_buffer)
+{
+	struct storage_buffer *buffer = storage_buffer_create(EVENTS);
+	struct storage_query query = {
+		.filter = "interface IN [\"eth1\", \"eth2\"] AND event_type == 1",
+		.group_by = QUERY_COL_BIT(QUERY_COL_INTERFACE),
+	};
+	struct storage_query_result result;
+	char data[64];
+	
+	ASSERT_NOT_NULL(buffer);
+	for (int i = 0; i < 1200; i++) {
+		struct nlmon_event event;
+	
+		make_event(&event, i, data, sizeof(data));
+		ASSERT_TRUE(storage_buffer_add(buffer, &event));
+	}
+	
+	/* Without a log the buffer is the one partition */
+	ASSERT_EQ(storage_query_run(NULL, buffer, &query, &result), QUERY_OK);
+	ASSERT_EQ(result.partitions, 1);
+	ASSERT_EQ(result.matched, 200);
+	ASSERT_EQ(result.num_rows, 2);
+	ASSERT_EQ(result.rows[0].count, 100);
+	ASSERT_EQ(result.rows[1].count, 100);
+	storage_query_result_free(&result);
+	
+	/* Neither storage to scan */
+	ASSERT_EQ(storage_query_run(NULL, NULL, &query, &result), QUERY_ERROR);
+	
+	storage_buffer_destroy(buffer);
+}
+
+TEST_SUITE_BEGIN("Storage Query")
+	RUN_TEST(storage_query_group_top_k);
+	RUN_TEST(storage_query_listing);
+	RUN_TEST(storage_query_limits);
+	RUN_TEST(storage_query_buffer);
+TEST_SUITE_END()
@@ -0,0 +1,192 @@
+/* test_storage_rollup.c - Unit tests for the event count rollup */
+
+#include "test_framework.h"
+#include "storage_rollup.h"
+#include "event_processor.h"
+#include <stdio.h>
+#include <string.h>
+
+#define SEC 1000000000ULL
+
+static void add_event(struct storage_rollup *rollup, uint64_t seconds, uint32_t type,
+                      const char *interface, uint32_t weight)
+{
+	struct nlmon_event event;
+	
+	memset(&event, 0, sizeof(event));
+	event.timestamp = seconds * SEC + 123;
+	event.event_type = type;
+	event.sample_weight = weight;
+	snprintf(event.interface, sizeof(event.interface), "%s", interface);
+	storage_rollup_add(rollup, &event);
+}
+
+/* Series handed on by a query, the last one's points copied */
+struct collected {
+	size_t count;
+	struct rollup_key key;
+	uint64_t start;
+	unsigned int step;
+	size_t num_points;
+	uint64_t points[64];
+	uint64_t total;
+};
+
+static void collect(const struct rollup_series *series, void *ctx)
+{
+	struct collected *c = ctx;
+	
+	c->count++;
+	c->key = series->key;
+	c->start = series->start;
+	c->step = series->step;
+	c->num_points = series->num_points;
+	c->total = series->total;
+	memcpy(c->points, series->points,
+	       (series->num_points < 64 ? series->num_points : 64) * sizeof(uint64_t));
+}
+
+TEST(storage_rollup_resolutions)
+{
+	struct storage_rollup *rollup = storage_rollup_create(NULL);
+	struct rollup_query query = { .resolution = ROLLUP_SECOND };
+	struct storage_rollup_stats stats;
+	struct collected c;
+	
+	ASSERT_NOT_NULL(rollup);
+	
+	/* Two events a second on eth0 for 2 minutes from 36000, one on eth1 */
+	for (uint64_t t = 36000; t < 36120; t++) {
+		add_event(rollup, t, 1, "eth0", 0);
+		add_event(rollup, t, 1, "eth0", 1);
+		add_event(rollup, t, 1, "eth1", 0);
+	}
+	
+	/* Per second, one series, start aligned */
+	memset(&c, 0, sizeof(c));
+	query.start = 36010;
+	query.end = 36020;
+	query.interface = "eth0";
+	ASSERT_EQ(storage_rollup_query(rollup, &query, collect, &c), 1);
+	ASSERT_STR_EQ(c.key.interface, "eth0");
+	ASSERT_EQ(c.key.event_type, 1);
+	ASSERT_EQ(c.start, 36010);
+	ASSERT_EQ(c.step, 1);
+	ASSERT_EQ(c.num_points, 10);
+	ASSERT_EQ(c.points[0], 2);
+	ASSERT_EQ(c.total, 20);
+	
+	/* Per minute, both interfaces apart and added up */
+	memset(&c, 0, sizeof(c));
+	query.resolution = ROLLUP_MINUTE;
+	query.start = 35940;
+	query.end = 0;
+	query.interface = NULL;
+	ASSERT_EQ(storage_rollup_query(rollup, &query, collect, &c), 2);
+	memset(&c, 0, sizeof(c));
+	query.sum = true;
+	ASSERT_EQ(storage_rollup_query(rollup, &query, collect, &c), 1);
+	ASSERT_EQ(c.step, 60);
+	ASSERT_EQ(c.num_points, 3);
+	ASSERT_EQ(c.points[0], 0);
+	ASSERT_EQ(c.points[c.num_points - 2], 180);
+	ASSERT_EQ(c.points[c.num_points - 1], 180);
+	ASSERT_EQ(c.total, 360);
+	
+	/* Per hour, no type 2 events */
+	memset(&c, 0, sizeof(c));
+	query.resolution = ROLLUP_HOUR;
+	query.start = 36000;
+	ASSERT_EQ(storage_rollup_query(rollup, &query, collect, &c), 1);
+	ASSERT_EQ(c.start, 36000);
+	ASSERT_EQ(c.total, 360);
+	query.match_type = true;
+	query.event_type = 2;
+	ASSERT_EQ(storage_rollup_query(rollup, &query, collect, &c), 0);
+	
+	storage_rollup_get_stats(rollup, &stats);
+	ASSERT_EQ(stats.events, 360);
+	ASSERT_EQ(stats.series, 2);
+	ASSERT_EQ(stats.newest, 36119);
+	
+	storage_rollup_destroy(rollup);
+}
+
+TEST(storage_rollup_retention)
+{
+	struct storage_rollup_config config = { .retention = { 10, 2, 2 } };
+	struct storage_rollup *rollup = storage_rollup_create(&config);
+	struct rollup_query query = { .resolution = ROLLUP_SECOND };
+	struct storage_rollup_stats stats;
+	struct collected c;
+	
+	ASSERT_NOT_NULL(rollup);
+	
+	/* Weighted events, the ring wraps several times */
+	for (uint64_t t = 100; t < 130; t++)
+		add_event(rollup, t, 3, "wlan0", 5);
+	
+	memset(&c, 0, sizeof(c));
+	ASSERT_EQ(storage_rollup_query(rollup, &query, collect, &c), 1);
+	ASSERT_EQ(c.start, 120);
+	ASSERT_EQ(c.num_points, 10);
+	ASSERT_EQ(c.points[0], 5);
+	ASSERT_EQ(c.total, 50);
+	
+	/* An event older than the seconds kept still counts per minute */
+	add_event(rollup, 105, 3, "wlan0", 1);
+	storage_rollup_get_stats(rollup, &stats);
+	ASSERT_EQ(stats.late, 1);
+	memset(&c, 0, sizeof(c));
+	query.resolution = ROLLUP_MINUTE;
+	ASSERT_EQ(storage_rollup_query(rollup, &query, collect, &c), 1);
+	ASSERT_EQ(c.start, 60);
+	ASSERT_EQ(c.points[0], 101);
+	ASSERT_EQ(c.points[1], 50);
+	
+	/* A gap longer than the ring clears it */
+	add_event(rollup, 1000, 3, "wlan0", 1);
+	memset(&c, 0, sizeof(c));
+	query.resolution = ROLLUP_SECOND;
+	ASSERT_EQ(storage_rollup_query(rollup, &query, collect, &c), 1);
+	ASSERT_EQ(c.start, 991);
+	ASSERT_EQ(c.total, 1);
+	
+	storage_rollup_destroy(rollup);
+}
+
+TEST(storage_rollup_overflow)
+{
+	struct storage_rollup_config config = { .max_series = 2 };
+	struct storage_rollup *rollup = storage_rollup_create(&config);
+	struct rollup_query query = { .resolution = ROLLUP_MINUTE };
+	struct storage_rollup_stats stats;
+	struct collected c;
+	
+	ASSERT_NOT_NULL(rollup);
+	add_event(rollup, 600, 1, "eth0", 0);
+	add_event(rollup, 600, 1, "eth1", 0);
+	add_event(rollup, 600, 1, "eth2", 0);
+	add_event(rollup, 600, 2, "eth2", 0);
+	
+	storage_rollup_get_stats(rollup, &stats);
+	ASSERT_EQ(stats.series, 2);
+	ASSERT_EQ(stats.overflow, 2);
+	
+	/* The overflow series only answers unfiltered queries */
+	memset(&c, 0, sizeof(c));
+	ASSERT_EQ(storage_rollup_query(rollup, &query, collect, &c), 3);
+	ASSERT_TRUE(c.key.overflow);
+	ASSERT_EQ(c.total, 2);
+	query.match_type = true;
+	query.event_type = 1;
+	ASSERT_EQ(storage_rollup_query(rollup, &query, collect, &c), 2);
+	
+	storage_rollup_destroy(rollup);
+}
+
+TEST_SUITE_BEGIN("Storage Rollup")
+	RUN_TEST(storage_rollup_resolutions);
+	RUN_TEST(storage_rollup_retention);
+	RUN_TEST(storage_rollup_overflow);
+TEST_SUITE_END()
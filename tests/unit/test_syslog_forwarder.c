@@ -0,0 +1,259 @@
+/* test_syslog_forwarder.c - Unit tests for syslog forwarding */
+
+#include "test_framework.h"
+#include "syslog_forwarder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* Bind a loopback socket to a free port, returns the socket or -1 */
+static int bind_loopback(int type, uint16_t *port)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	struct timeval timeout = { .tv_sec = 5 };
+	int opt = 1;
+	int sock;
+	
+	sock = socket(AF_INET, type, 0);
+	if (sock < 0)
+		return -1;
+	
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(*port);
+	
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    getsockname(sock, (struct sockaddr *)&addr, &len) < 0 ||
+	    (type == SOCK_STREAM && listen(sock, 4) < 0)) {
+		close(sock);
+		return -1;
+	}
+	
+	*port = ntohs(addr.sin_port);
+	return sock;
+}
+
+static void send_numbered(struct syslog_forwarder *forwarder, int first, int n)
+{
+	char text[32];
+	struct syslog_message msg = {
+		.severity = SYSLOG_WARNING,
+		.msg_id = "TEST",
+		.message = text,
+	};
+	
+	for (int i = first; i < first + n; i++) {
+		snprintf(text, sizeof(text), "message %d", i);
+		syslog_forwarder_send(forwarder, &msg);
+	}
+}
+
+/* Read octet-counted frames from a stream, returns the number read */
+static int read_frames(int sock, char frames[][256], int max)
+{
+	static char buf[65536];
+	size_t len = 0, pos = 0;
+	int count = 0;
+	ssize_t n;
+	
+	while (count < max) {
+		char *space = memchr(buf + pos, ' ', len - pos);
+		size_t frame_len;
+		
+		if (space) {
+			frame_len = strtoul(buf + pos, NULL, 10);
+			if ((size_t)(space + 1 - buf) + frame_len <= len) {
+				if (frame_len >= 256)
+					return -1;
+				memcpy(frames[count], space + 1, frame_len);
+				frames[count++][frame_len] = '\0';
+				pos = (size_t)(space + 1 - buf) + frame_len;
+				continue;
+			}
+		}
+		
+		n = recv(sock, buf + len, sizeof(buf) - len, 0);
+		if (n <= 0)
+			break;
+		len += (size_t)n;
+	}
+	
+	return count;
+}
+
+TEST(syslog_udp_batches)
+{
+	struct syslog_config config = {
+		.server = "127.0.0.1",
+		.transport = SYSLOG_TRANSPORT_UDP,
+		.facility = SYSLOG_LOCAL0,
+		.hostname = "host1",
+		.app_name = "nlmon",
+		.batch_size = 4,
+	};
+	struct syslog_forwarder *forwarder;
+	uint64_t sent, failed;
+	char buf[512], expected[32];
+	uint16_t port = 0;
+	ssize_t len;
+	int sock;
+	
+	sock = bind_loopback(SOCK_DGRAM, &port);
+	ASSERT_TRUE(sock >= 0);
+	config.port = port;
+	
+	forwarder = syslog_forwarder_create(&config);
+	ASSERT_NOT_NULL(forwarder);
+	ASSERT_TRUE(syslog_forwarder_is_connected(forwarder));
+	
+	/* Two full batches go out, the last two wait for a flush */
+	send_numbered(forwarder, 0, 10);
+	ASSERT_TRUE(syslog_forwarder_get_stats(forwarder, &sent, &failed, NULL));
+	ASSERT_EQ(sent, 8);
+	ASSERT_TRUE(syslog_forwarder_flush(forwarder));
+	ASSERT_TRUE(syslog_forwarder_get_stats(forwarder, &sent, &failed, NULL));
+	ASSERT_EQ(sent, 10);
+	ASSERT_EQ(failed, 0);
+	
+	/* One message per datagram, in order */
+	for (int i = 0; i < 10; i++) {
+		len = recv(sock, buf, sizeof(buf) - 1, 0);
+		ASSERT_TRUE(len > 0);
+		buf[len] = '\0';
+		
+		/* <132> is local0.warning */
+		ASSERT_EQ(strncmp(buf, "<132>1 ", 7), 0);
+		ASSERT_EQ(buf[len - 1], (char)('0' + i));
+		ASSERT_NOT_NULL(strstr(buf, "Z host1 nlmon - TEST - message "));
+		snprintf(expected, sizeof(expected), " message %d", i);
+		ASSERT_STR_EQ(strstr(buf, " message "), expected);
+	}
+	
+	syslog_forwarder_destroy(forwarder);
+	close(sock);
+}
+
+TEST(syslog_tcp_octet_framing)
+{
+	struct syslog_config config = {
+		.server = "127.0.0.1",
+		.transport = SYSLOG_TRANSPORT_TCP,
+		.facility = SYSLOG_DAEMON,
+		.hostname = "host2",
+		.batch_size = 16,
+	};
+	struct syslog_forwarder *forwarder;
+	char frames[20][256], expected[64];
+	uint16_t port = 0;
+	int listener, sock;
+	
+	listener = bind_loopback(SOCK_STREAM, &port);
+	ASSERT_TRUE(listener >= 0);
+	config.port = port;
+	
+	forwarder = syslog_forwarder_create(&config);
+	ASSERT_NOT_NULL(forwarder);
+	sock = accept(listener, NULL, NULL);
+	ASSERT_TRUE(sock >= 0);
+	
+	send_numbered(forwarder, 0, 20);
+	ASSERT_TRUE(syslog_forwarder_flush(forwarder));
+	
+	ASSERT_EQ(read_frames(sock, frames, 20), 20);
+	for (int i = 0; i < 20; i++) {
+		snprintf(expected, sizeof(expected), "host2 nlmon - TEST - message %d", i);
+		ASSERT_EQ(strncmp(frames[i], "<28>1 ", 6), 0);
+		ASSERT_STR_EQ(strstr(frames[i], "host2 "), expected);
+	}
+	
+	syslog_forwarder_destroy(forwarder);
+	close(sock);
+	close(listener);
+}
+
+TEST(syslog_reconnect_buffer)
+{
+	struct syslog_config config = {
+		.server = "127.0.0.1",
+		.transport = SYSLOG_TRANSPORT_TCP,
+		.hostname = "host3",
+		.reconnect = true,
+		.reconnect_interval = 3600,
+		.batch_size = 1,
+		.buffer_size = 16384,
+	};
+	struct syslog_forwarder *forwarder;
+	char frames[8][256], expected[64];
+	uint64_t sent, failed;
+	uint32_t reconnections;
+	uint16_t port = 0;
+	int listener, sock, queued = 0;
+	
+	/* Find a free port and leave it unused */
+	listener = bind_loopback(SOCK_STREAM, &port);
+	ASSERT_TRUE(listener >= 0);
+	close(listener);
+	config.port = port;
+	
+	forwarder = syslog_forwarder_create(&config);
+	ASSERT_NOT_NULL(forwarder);
+	ASSERT_FALSE(syslog_forwarder_is_connected(forwarder));
+	
+	/* Held within the reconnect interval, not retried per message */
+	send_numbered(forwarder, 0, 5);
+	ASSERT_FALSE(syslog_forwarder_flush(forwarder));
+	ASSERT_TRUE(syslog_forwarder_get_stats(forwarder, &sent, &failed, &reconnections));
+	ASSERT_EQ(sent, 0);
+	ASSERT_EQ(failed, 0);
+	ASSERT_EQ(reconnections, 0);
+	
+	/* Bounded, a full buffer drops new messages */
+	while (queued < 1000) {
+		struct syslog_message msg = { .severity = SYSLOG_INFO, .message = "filler" };
+		
+		if (!syslog_forwarder_send(forwarder, &msg))
+			break;
+		queued++;
+	}
+	ASSERT_TRUE(queued < 1000);
+	ASSERT_TRUE(syslog_forwarder_get_stats(forwarder, NULL, &failed, NULL));
+	ASSERT_EQ(failed, 1);
+	
+	/* The held messages are sent first once the server is back */
+	listener = bind_loopback(SOCK_STREAM, &port);
+	ASSERT_TRUE(listener >= 0);
+	ASSERT_TRUE(syslog_forwarder_reconnect(forwarder));
+	sock = accept(listener, NULL, NULL);
+	ASSERT_TRUE(sock >= 0);
+	
+	ASSERT_EQ(read_frames(sock, frames, 8), 8);
+	for (int i = 0; i < 5; i++) {
+		snprintf(expected, sizeof(expected), "host3 nlmon - TEST - message %d", i);
+		ASSERT_STR_EQ(strstr(frames[i], "host3 "), expected);
+	}
+	ASSERT_NOT_NULL(strstr(frames[5], " - - - filler"));
+	
+	ASSERT_TRUE(syslog_forwarder_get_stats(forwarder, &sent, NULL, &reconnections));
+	ASSERT_EQ(sent, 5 + (uint64_t)queued);
+	ASSERT_EQ(reconnections, 1);
+	
+	syslog_forwarder_destroy(forwarder);
+	close(sock);
+	close(listener);
+}
+
+TEST_SUITE_BEGIN("Syslog Forwarder")
+	RUN_TEST(syslog_udp_batches);
+	RUN_TEST(syslog_tcp_octet_framing);
+	RUN_TEST(syslog_reconnect_buffer);
+TEST_SUITE_END()
@@ -0,0 +1,390 @@
+/* test_thread_pool.c - Unit tests for elastic sizing and work stealing */
+
+#include "test_framework.h"
+#include "thread_pool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+static _Atomic int in_flight;
+static _Atomic int max_in_flight;
+static _Atomic int done;
+
+/* Blocks like a handler waiting on I/O, so workers overlap on one CPU */
+static void slow_work(void *arg)
+{
+	int now = atomic_fetch_add(&in_flight, 1) + 1;
+	int max = atomic_load(&max_in_flight);
+	
+	while (now > max && !atomic_compare_exchange_weak(&max_in_flight, &max, now))
+		;
+	usleep(5000);
+	atomic_fetch_sub(&in_flight, 1);
+	atomic_fetch_add(&done, 1);
+}
+
+static struct thread_pool *create_elastic(size_t min, size_t max, unsigned int idle_ms)
+{
+	struct thread_pool_options opts;
+	
+	memset(&opts, 0, sizeof(opts));
+	opts.num_threads = min;
+	opts.min_threads = min;
+	opts.max_threads = max;
+	opts.target_wait_us = 1000;
+	opts.idle_ms = idle_ms;
+	return thread_pool_create_opts(&opts);
+}
+
+static void submit_slow(struct thread_pool *pool, int count)
+{
+	atomic_store(&in_flight, 0);
+	atomic_store(&max_in_flight, 0);
+	atomic_store(&done, 0);
+	
+	/* Paced so the oldest item ages while submissions continue */
+	for (int i = 0; i < count; i++) {
+		thread_pool_submit(pool, slow_work, NULL, PRIORITY_NORMAL);
+		usleep(500);
+	}
+}
+
+TEST(grows_when_queue_wait_exceeds_target)
+{
+	struct thread_pool *pool = create_elastic(1, 4, 10000);
+	unsigned long grown = 0, shrunk = 0;
+	
+	ASSERT_NOT_NULL(pool);
+	ASSERT_EQ(thread_pool_get_thread_count(pool), 1);
+	
+	submit_slow(pool, 100);
+	thread_pool_wait(pool);
+	
+	ASSERT_EQ(atomic_load(&done), 100);
+	ASSERT_TRUE(atomic_load(&max_in_flight) > 1);
+	ASSERT_TRUE(thread_pool_get_thread_count(pool) > 1);
+	thread_pool_elastic_stats(pool, &grown, &shrunk, NULL);
+	ASSERT_TRUE(grown > 0);
+	ASSERT_EQ(shrunk, 0);
+	
+	thread_pool_destroy(pool, true);
+}
+
+TEST(never_exceeds_max_threads)
+{
+	struct thread_pool *pool = create_elastic(1, 3, 10000);
+	
+	ASSERT_NOT_NULL(pool);
+	submit_slow(pool, 150);
+	ASSERT_TRUE(thread_pool_get_thread_count(pool) <= 3);
+	thread_pool_wait(pool);
+	
+	ASSERT_TRUE(atomic_load(&max_in_flight) <= 3);
+	ASSERT_EQ(thread_pool_get_thread_count(pool), 3);
+	
+	thread_pool_destroy(pool, true);
+}
+
+TEST(shrinks_to_min_after_idle_period)
+{
+	struct thread_pool *pool = create_elastic(1, 4, 50);
+	unsigned long grown = 0, shrunk = 0;
+	
+	ASSERT_NOT_NULL(pool);
+	submit_slow(pool, 100);
+	thread_pool_wait(pool);
+	ASSERT_TRUE(thread_pool_get_thread_count(pool) > 1);
+	
+	/* Workers leave one idle period apart */
+	for (int wait = 0; wait < 100 && thread_pool_get_thread_count(pool) > 1; wait++)
+		usleep(10000);
+	ASSERT_EQ(thread_pool_get_thread_count(pool), 1);
+	thread_pool_elastic_stats(pool, &grown, &shrunk, NULL);
+	ASSERT_EQ(shrunk, grown);
+	
+	/* Retired slots are reused on the next burst */
+	submit_slow(pool, 100);
+	thread_pool_wait(pool);
+	ASSERT_EQ(atomic_load(&done), 100);
+	ASSERT_TRUE(thread_pool_get_thread_count(pool) > 1);
+	
+	thread_pool_destroy(pool, true);
+}
+
+TEST(fixed_pool_keeps_its_size)
+{
+	struct thread_pool *pool = thread_pool_create(2, 0);
+	unsigned long grown = 1, shrunk = 1, wait_us = 1;
+	
+	ASSERT_NOT_NULL(pool);
+	submit_slow(pool, 50);
+	thread_pool_wait(pool);
+	
+	ASSERT_EQ(atomic_load(&done), 50);
+	ASSERT_EQ(thread_pool_get_thread_count(pool), 2);
+	thread_pool_elastic_stats(pool, &grown, &shrunk, &wait_us);
+	ASSERT_EQ(grown, 0);
+	ASSERT_EQ(shrunk, 0);
+	ASSERT_EQ(wait_us, 0);
+	
+	thread_pool_destroy(pool, true);
+}
+
+TEST(work_stealing_pool_is_not_elastic)
+{
+	struct thread_pool_options opts;
+	struct thread_pool *pool;
+	
+	memset(&opts, 0, sizeof(opts));
+	opts.num_threads = 2;
+	opts.max_threads = 8;
+	opts.mode = THREAD_POOL_WORK_STEALING;
+	pool = thread_pool_create_opts(&opts);
+	ASSERT_NOT_NULL(pool);
+	
+	submit_slow(pool, 50);
+	thread_pool_wait(pool);
+	ASSERT_EQ(atomic_load(&done), 50);
+	ASSERT_EQ(thread_pool_get_thread_count(pool), 2);
+	
+	thread_pool_destroy(pool, true);
+}
+
+TEST(destroy_discards_queue_of_elastic_pool)
+{
+	struct thread_pool *pool = create_elastic(1, 2, 10);
+	
+	ASSERT_NOT_NULL(pool);
+	for (int i = 0; i < 50; i++)
+		ASSERT_TRUE(thread_pool_submit(pool, slow_work, NULL, PRIORITY_NORMAL));
+	thread_pool_destroy(pool, false);
+}
+
+/* Work-stealing stress, every accepted task must run exactly once */
+#define WS_TASKS 8192
+#define WS_FANOUT 4
+
+struct ws_task {
+	struct thread_pool *pool;
+	int depth;                /* Levels of children it submits */
+	int sleep_us;
+};
+
+static struct ws_task ws_tasks[WS_TASKS];
+static _Atomic int ws_runs[WS_TASKS];
+static _Atomic bool ws_accepted[WS_TASKS];
+static _Atomic int ws_next;
+static _Atomic int ws_finished;
+static _Atomic bool ws_hog_timed_out;
+static _Atomic bool ws_destroyed;
+
+static void ws_task_run(void *arg);
+
+static void ws_reset(void)
+{
+	for (int i = 0; i < WS_TASKS; i++) {
+		atomic_store(&ws_runs[i], 0);
+		atomic_store(&ws_accepted[i], false);
+	}
+	atomic_store(&ws_next, 0);
+	atomic_store(&ws_finished, 0);
+	atomic_store(&ws_hog_timed_out, false);
+	atomic_store(&ws_destroyed, false);
+}
+
+/* Submits a task, to the calling worker's own deque when run by one */
+static bool ws_spawn(struct thread_pool *pool, work_func_t func, int depth, int sleep_us)
+{
+	int id = atomic_fetch_add(&ws_next, 1);
+	
+	if (id >= WS_TASKS)
+		return false;
+	
+	ws_tasks[id].pool = pool;
+	ws_tasks[id].depth = depth;
+	ws_tasks[id].sleep_us = sleep_us;
+	if (!thread_pool_submit(pool, func, &ws_tasks[id], PRIORITY_NORMAL))
+		return false;
+	atomic_store(&ws_accepted[id], true);
+	return true;
+}
+
+static void ws_task_run(void *arg)
+{
+	struct ws_task *task = arg;
+	
+	atomic_fetch_add(&ws_runs[task - ws_tasks], 1);
+	if (task->sleep_us)
+		usleep(task->sleep_us);
+	for (int i = 0; task->depth > 0 && i < WS_FANOUT; i++)
+		ws_spawn(task->pool, ws_task_run, task->depth - 1, task->sleep_us);
+	atomic_fetch_add(&ws_finished, 1);
+}
+
+/* Keeps its worker busy until the children it queued there ran elsewhere */
+static void ws_hog_run(void *arg)
+{
+	struct ws_task *task = arg;
+	int wait;
+	
+	atomic_fetch_add(&ws_runs[task - ws_tasks], 1);
+	for (int i = 0; i < task->depth; i++)
+		ws_spawn(task->pool, ws_task_run, 0, task->sleep_us);
+	for (wait = 0; wait < 50000 && atomic_load(&ws_finished) < task->depth; wait++)
+		usleep(100);
+	if (atomic_load(&ws_finished) < task->depth)
+		atomic_store(&ws_hog_timed_out, true);
+}
+
+/* Accepted tasks that did not run exactly once, and tasks run unaccepted */
+static int ws_run_errors(int *accepted)
+{
+	int errors = 0, count = atomic_load(&ws_next);
+	
+	if (count > WS_TASKS)
+		count = WS_TASKS;
+	*accepted = 0;
+	for (int i = 0; i < count; i++) {
+		int runs = atomic_load(&ws_runs[i]);
+		
+		if (atomic_load(&ws_accepted[i])) {
+			(*accepted)++;
+			errors += runs != 1;
+		} else {
+			errors += runs != 0;
+		}
+	}
+	return errors;
+}
+
+static struct thread_pool *create_stealing(size_t threads)
+{
+	struct thread_pool_options opts;
+	
+	memset(&opts, 0, sizeof(opts));
+	opts.num_threads = threads;
+	opts.mode = THREAD_POOL_WORK_STEALING;
+	return thread_pool_create_opts(&opts);
+}
+
+TEST(work_stealing_tasks_submitted_by_workers)
+{
+	struct thread_pool *pool = create_stealing(4);
+	unsigned long submitted, completed, rejected;
+	int accepted;
+	
+	ASSERT_NOT_NULL(pool);
+	ws_reset();
+	
+	/* 16 trees of 1 + 4 + 16 + 64 + 256 tasks */
+	for (int i = 0; i < 16; i++)
+		ASSERT_TRUE(ws_spawn(pool, ws_task_run, 4, 0));
+	thread_pool_wait(pool);
+	
+	ASSERT_EQ(ws_run_errors(&accepted), 0);
+	ASSERT_EQ(accepted, 16 * 341);
+	thread_pool_stats(pool, &submitted, &completed, &rejected);
+	ASSERT_EQ(submitted, 16 * 341);
+	ASSERT_EQ(completed, submitted);
+	ASSERT_EQ(rejected, 0);
+	ASSERT_EQ(thread_pool_get_pending_count(pool), 0);
+	
+	thread_pool_destroy(pool, true);
+}
+
+TEST(work_stealing_idle_workers_steal)
+{
+	struct thread_pool *pool = create_stealing(8);
+	unsigned long steals = 0, parks = 0;
+	int accepted;
+	
+	ASSERT_NOT_NULL(pool);
+	
+	for (int round = 0; round < 20; round++) {
+		ws_reset();
+		
+		/* Let the workers park before anything is queued */
+		usleep(5000);
+		
+		/* The hog's worker never gets back to its own deque, thieves race for it */
+		ASSERT_TRUE(ws_spawn(pool, ws_hog_run, 1000, 0));
+		thread_pool_wait(pool);
+		
+		ASSERT_FALSE(atomic_load(&ws_hog_timed_out));
+		ASSERT_EQ(ws_run_errors(&accepted), 0);
+		ASSERT_EQ(accepted, 1001);
+	}
+	
+	thread_pool_sched_stats(pool, &steals, &parks);
+	ASSERT_TRUE(steals >= 20 * 1000);
+	ASSERT_TRUE(parks > 0);
+	
+	thread_pool_destroy(pool, true);
+}
+
+static void *ws_destroy_thread(void *arg)
+{
+	thread_pool_destroy(arg, true);
+	atomic_store(&ws_destroyed, true);
+	return NULL;
+}
+
+TEST(work_stealing_shutdown_drains_queued_work)
+{
+	struct thread_pool *pool = create_stealing(4);
+	pthread_t thread;
+	int accepted, wait;
+	
+	ASSERT_NOT_NULL(pool);
+	ws_reset();
+	
+	/* Trees still spawning children while the pool shuts down */
+	for (int i = 0; i < 64; i++)
+		ASSERT_TRUE(ws_spawn(pool, ws_task_run, 3, 100));
+	ASSERT_TRUE(thread_pool_get_pending_count(pool) > 0);
+	
+	/* A parked worker left behind would keep destroy from returning */
+	pthread_create(&thread, NULL, ws_destroy_thread, pool);
+	for (wait = 0; wait < 1000 && !atomic_load(&ws_destroyed); wait++)
+		usleep(10000);
+	ASSERT_TRUE(atomic_load(&ws_destroyed));
+	pthread_join(thread, NULL);
+	
+	ASSERT_EQ(ws_run_errors(&accepted), 0);
+	ASSERT_TRUE(accepted >= 64);
+	ASSERT_EQ(atomic_load(&ws_finished), accepted);
+}
+
+TEST(work_stealing_immediate_shutdown_runs_nothing_twice)
+{
+	struct thread_pool *pool = create_stealing(4);
+	int accepted;
+	
+	ASSERT_NOT_NULL(pool);
+	ws_reset();
+	
+	for (int i = 0; i < 64; i++)
+		ASSERT_TRUE(ws_spawn(pool, ws_task_run, 3, 100));
+	thread_pool_destroy(pool, false);
+	
+	/* Discarded tasks count as errors here, only check for double runs */
+	ws_run_errors(&accepted);
+	for (int i = 0; i < WS_TASKS; i++)
+		ASSERT_TRUE(atomic_load(&ws_runs[i]) <= 1);
+	ASSERT_TRUE(atomic_load(&ws_finished) <= accepted);
+}
+
+TEST_SUITE_BEGIN("Thread Pool")
+	RUN_TEST(grows_when_queue_wait_exceeds_target);
+	RUN_TEST(never_exceeds_max_threads);
+	RUN_TEST(shrinks_to_min_after_idle_period);
+	RUN_TEST(fixed_pool_keeps_its_size);
+	RUN_TEST(work_stealing_pool_is_not_elastic);
+	RUN_TEST(destroy_discards_queue_of_elastic_pool);
+	RUN_TEST(work_stealing_tasks_submitted_by_workers);
+	RUN_TEST(work_stealing_idle_workers_steal);
+	RUN_TEST(work_stealing_shutdown_drains_queued_work);
+	RUN_TEST(work_stealing_immediate_shutdown_runs_nothing_twice);
+TEST_SUITE_END()
@@ -0,0 +1,425 @@
+/* test_web_stream.c - Unit tests for filtered WebSocket and SSE streams */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "test_framework.h"
+#include "web_stream.h"
+#include "websocket_server.h"
+#include "event_processor.h"
+#include "event_cbor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define TEST_PORT 19490
+
+static struct web_stream *test_stream;
+
+/* Every client message is a filter expression to subscribe with */
+static void subscribe_message(struct ws_connection *conn, const char *message, size_t len,
+                              void *user_data)
+{
+	char error[128];
+	(void)len;
+	(void)user_data;
+	
+	if (web_stream_subscribe_ws(test_stream, conn, message, error, sizeof(error)) == 0)
+		websocket_send(conn, "ok", 2);
+	else
+		websocket_send(conn, error, strlen(error));
+}
+
+static void unsubscribe_disconnect(struct ws_connection *conn, void *user_data)
+{
+	(void)user_data;
+	web_stream_unsubscribe_ws(test_stream, conn);
+}
+
+static void make_event(struct nlmon_event *event, const char *interface, uint64_t sequence)
+{
+	memset(event, 0, sizeof(*event));
+	event->sequence = sequence;
+	event->message_type = 16;
+	snprintf(event->interface, sizeof(event->interface), "%s", interface);
+}
+
+/* Connect offering a subprotocol (or NULL) and complete the upgrade,
+ * returns the socket or -1. The server must agree on the subprotocol. */
+static int ws_connect_protocol(uint16_t port, const char *protocol)
+{
+	struct timeval tv = { .tv_sec = 2 };
+	struct sockaddr_in addr;
+	char request[512];
+	char response[512];
+	char agreed[128];
+	size_t len = 0;
+	int one = 1;
+	int sock;
+	
+	snprintf(request, sizeof(request),
+		 "GET /ws HTTP/1.1\r\n"
+		 "Host: localhost\r\n"
+		 "Upgrade: websocket\r\n"
+		 "Connection: Upgrade\r\n"
+		 "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+		 "Sec-WebSocket-Version: 13\r\n"
+		 "%s%s%s"
+		 "\r\n", protocol ? "Sec-WebSocket-Protocol: chat, " : "",
+		 protocol ? protocol : "", protocol ? "\r\n" : "");
+	snprintf(agreed, sizeof(agreed), "\r\nSec-WebSocket-Protocol: %s\r\n",
+		 protocol ? protocol : "");
+	
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0)
+		return -1;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    send(sock, request, strlen(request), 0) < 0)
+		goto fail;
+	
+	while (len < sizeof(response) - 1) {
+		if (recv(sock, response + len, 1, 0) != 1)
+			goto fail;
+		len++;
+		response[len] = '\0';
+		if (len >= 4 && strcmp(response + len - 4, "\r\n\r\n") == 0)
+			break;
+	}
+	
+	if (strncmp(response, "HTTP/1.1 101", 12) != 0)
+		goto fail;
+	if (protocol ? !strstr(response, agreed) : strstr(response, "Sec-WebSocket-Protocol") != NULL)
+		goto fail;
+	
+	return sock;
+	
+fail:
+	close(sock);
+	return -1;
+}
+
+static int ws_connect(uint16_t port)
+{
+	return ws_connect_protocol(port, NULL);
+}
+
+/* Send a masked text frame shorter than 126 bytes */
+static bool ws_send_text(int sock, const char *text)
+{
+	static const unsigned char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+	unsigned char frame[132];
+	size_t len = strlen(text);
+	
+	if (len >= 126)
+		return false;
+	frame[0] = 0x81;
+	frame[1] = 0x80 | len;
+	memcpy(frame + 2, mask, 4);
+	for (size_t i = 0; i < len; i++)
+		frame[6 + i] = text[i] ^ mask[i % 4];
+	return send(sock, frame, 6 + len, 0) == (ssize_t)(6 + len);
+}
+
+/* Read one short server frame of an opcode, returns the payload length or -1 */
+static ssize_t ws_read_frame(int sock, int opcode, char *buf, size_t size)
+{
+	unsigned char header[2];
+	size_t len, got = 0;
+	
+	if (recv(sock, header, 2, MSG_WAITALL) != 2)
+		return -1;
+	if ((header[0] & 0x0f) != opcode)
+		return -1;
+	len = header[1] & 0x7f;
+	if (len >= 126 || len >= size)
+		return -1;
+	while (got < len) {
+		ssize_t n = recv(sock, buf + got, len - got, 0);
+		if (n <= 0)
+			return -1;
+		got += (size_t)n;
+	}
+	buf[len] = '\0';
+	return (ssize_t)len;
+}
+
+static ssize_t ws_read_text(int sock, char *buf, size_t size)
+{
+	return ws_read_frame(sock, 0x1, buf, size);
+}
+
+/* True if nothing arrives on the socket within 100 ms */
+static bool ws_quiet(int sock)
+{
+	struct timeval tv = { .tv_usec = 100000 };
+	struct timeval restore = { .tv_sec = 2 };
+	char byte;
+	ssize_t n;
+	
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	n = recv(sock, &byte, 1, 0);
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &restore, sizeof(restore));
+	return n < 0;
+}
+
+TEST(stream_groups_shared)
+{
+	struct web_stream *stream = web_stream_create();
+	struct web_stream_sse *a, *b, *c;
+	struct web_stream_stats stats;
+	struct nlmon_event event;
+	char error[128];
+	
+	ASSERT_NOT_NULL(stream);
+	a = web_stream_sse_open(stream, "interface == \"eth0\"", error, sizeof(error));
+	b = web_stream_sse_open(stream, "  interface   ==\t\"eth0\" ", error, sizeof(error));
+	c = web_stream_sse_open(stream, "interface == \"eth1\"", error, sizeof(error));
+	ASSERT_NOT_NULL(a);
+	ASSERT_NOT_NULL(b);
+	ASSERT_NOT_NULL(c);
+	
+	/* Spacing does not make a new group, spacing in a string does */
+	web_stream_get_stats(stream, &stats);
+	ASSERT_EQ(stats.groups, 2);
+	ASSERT_EQ(stats.subscribers, 3);
+	
+	/* Each group's filter runs once per event */
+	for (int i = 0; i < 10; i++) {
+		make_event(&event, i % 2 ? "eth1" : "eth0", i);
+		ASSERT_EQ(web_stream_publish(stream, &event, "{}", 2), i % 2 ? 1 : 2);
+	}
+	web_stream_get_stats(stream, &stats);
+	ASSERT_EQ(stats.events, 10);
+	ASSERT_EQ(stats.filter_evals, 20);
+	ASSERT_EQ(stats.deliveries, 15);
+	
+	web_stream_sse_close(a);
+	web_stream_get_stats(stream, &stats);
+	ASSERT_EQ(stats.groups, 2);
+	web_stream_sse_close(b);
+	web_stream_get_stats(stream, &stats);
+	ASSERT_EQ(stats.groups, 1);
+	web_stream_sse_close(c);
+	web_stream_get_stats(stream, &stats);
+	ASSERT_EQ(stats.groups, 0);
+	ASSERT_EQ(stats.subscribers, 0);
+	
+	web_stream_destroy(stream);
+}
+
+TEST(stream_invalid_filter)
+{
+	struct web_stream *stream = web_stream_create();
+	char error[128] = "";
+	
+	ASSERT_NOT_NULL(stream);
+	ASSERT_NULL(web_stream_sse_open(stream, "interface == ", error, sizeof(error)));
+	ASSERT_TRUE(strstr(error, "column") != NULL);
+	
+	web_stream_destroy(stream);
+}
+
+TEST(stream_sse_read)
+{
+	struct web_stream *stream = web_stream_create();
+	struct web_stream_sse *sse;
+	struct nlmon_event event;
+	char error[128];
+	char buf[256];
+	
+	ASSERT_NOT_NULL(stream);
+	sse = web_stream_sse_open(stream, "interface == \"eth0\"", error, sizeof(error));
+	ASSERT_NOT_NULL(sse);
+	
+	/* Nothing queued times out */
+	ASSERT_EQ(web_stream_sse_read(sse, buf, sizeof(buf), 10), 0);
+	
+	make_event(&event, "eth1", 1);
+	ASSERT_EQ(web_stream_publish(stream, &event, "{\"seq\":1}", 9), 0);
+	make_event(&event, "eth0", 2);
+	ASSERT_EQ(web_stream_publish(stream, &event, "{\"seq\":2}", 9), 1);
+	
+	ssize_t n = web_stream_sse_read(sse, buf, sizeof(buf) - 1, 100);
+	ASSERT_TRUE(n > 0);
+	buf[n] = '\0';
+	ASSERT_STR_EQ(buf, "data: {\"seq\":2}\n\n");
+	
+	/* Shutdown ends reads */
+	web_stream_shutdown(stream);
+	ASSERT_EQ(web_stream_sse_read(sse, buf, sizeof(buf), 1000), -1);
+	
+	web_stream_sse_close(sse);
+	web_stream_destroy(stream);
+}
+
+TEST(stream_websocket_filtered)
+{
+	struct websocket_config config = {
+		.port = TEST_PORT,
+		.on_message = subscribe_message,
+		.on_disconnect = unsubscribe_disconnect,
+		.threads = 2,
+	};
+	struct websocket_server *server;
+	struct web_stream_stats stats;
+	struct nlmon_event event;
+	char buf[128];
+	int eth0, eth1, all;
+	
+	test_stream = web_stream_create();
+	ASSERT_NOT_NULL(test_stream);
+	server = websocket_server_init(&config);
+	ASSERT_NOT_NULL(server);
+	ASSERT_EQ(websocket_server_start(server), 0);
+	
+	eth0 = ws_connect(TEST_PORT);
+	eth1 = ws_connect(TEST_PORT);
+	all = ws_connect(TEST_PORT);
+	ASSERT_TRUE(eth0 >= 0 && eth1 >= 0 && all >= 0);
+	
+	ASSERT_TRUE(ws_send_text(eth0, "interface == \"eth0\""));
+	ASSERT_TRUE(ws_send_text(eth1, "interface == \"eth1\""));
+	ASSERT_TRUE(ws_send_text(all, ""));
+	ASSERT_EQ(ws_read_text(eth0, buf, sizeof(buf)), 2);
+	ASSERT_EQ(ws_read_text(eth1, buf, sizeof(buf)), 2);
+	ASSERT_EQ(ws_read_text(all, buf, sizeof(buf)), 2);
+	
+	/* An invalid filter keeps the previous subscription */
+	ASSERT_TRUE(ws_send_text(eth1, "interface =="));
+	ASSERT_TRUE(ws_read_text(eth1, buf, sizeof(buf)) > 0);
+	ASSERT_TRUE(strcmp(buf, "ok") != 0);
+	
+	make_event(&event, "eth0", 1);
+	ASSERT_EQ(web_stream_publish(test_stream, &event, "eth0-event", 10), 2);
+	ASSERT_EQ(ws_read_text(eth0, buf, sizeof(buf)), 10);
+	ASSERT_STR_EQ(buf, "eth0-event");
+	ASSERT_EQ(ws_read_text(all, buf, sizeof(buf)), 10);
+	ASSERT_STR_EQ(buf, "eth0-event");
+	ASSERT_TRUE(ws_quiet(eth1));
+	
+	make_event(&event, "eth1", 2);
+	ASSERT_EQ(web_stream_publish(test_stream, &event, "eth1-event", 10), 2);
+	ASSERT_EQ(ws_read_text(eth1, buf, sizeof(buf)), 10);
+	ASSERT_STR_EQ(buf, "eth1-event");
+	ASSERT_EQ(ws_read_text(all, buf, sizeof(buf)), 10);
+	ASSERT_TRUE(ws_quiet(eth0));
+	
+	/* Two filtered groups per event, the unfiltered one is never evaluated */
+	web_stream_get_stats(test_stream, &stats);
+	ASSERT_EQ(stats.groups, 3);
+	ASSERT_EQ(stats.filter_evals, 4);
+	
+	close(eth0);
+	close(eth1);
+	close(all);
+	websocket_server_cleanup(server);
+	web_stream_get_stats(test_stream, &stats);
+	ASSERT_EQ(stats.subscribers, 0);
+	web_stream_destroy(test_stream);
+	test_stream = NULL;
+}
+
+TEST(stream_websocket_cbor)
+{
+	static const char *const subprotocols[] = { EVENT_CBOR_SUBPROTOCOL, NULL };
+	static const char eth0_definition[] = "\x83\x01\x00\x64" "eth0";
+	static const char eth1_definition[] = "\x83\x01\x01\x64" "eth1";
+	struct websocket_config config = {
+		.port = TEST_PORT + 1,
+		.on_message = subscribe_message,
+		.on_disconnect = unsubscribe_disconnect,
+		.threads = 2,
+		.subprotocols = subprotocols,
+	};
+	struct websocket_server *server;
+	struct nlmon_event event;
+	char buf[128];
+	int text, all, eth1, late;
+	
+	test_stream = web_stream_create();
+	ASSERT_NOT_NULL(test_stream);
+	server = websocket_server_init(&config);
+	ASSERT_NOT_NULL(server);
+	ASSERT_EQ(websocket_server_start(server), 0);
+	
+	/* Clients offering nothing stay on JSON */
+	text = ws_connect(TEST_PORT + 1);
+	all = ws_connect_protocol(TEST_PORT + 1, EVENT_CBOR_SUBPROTOCOL);
+	eth1 = ws_connect_protocol(TEST_PORT + 1, EVENT_CBOR_SUBPROTOCOL);
+	ASSERT_TRUE(text >= 0 && all >= 0 && eth1 >= 0);
+	ASSERT_TRUE(ws_send_text(text, ""));
+	ASSERT_TRUE(ws_send_text(all, ""));
+	ASSERT_TRUE(ws_send_text(eth1, "interface == \"eth1\""));
+	ASSERT_EQ(ws_read_text(text, buf, sizeof(buf)), 2);
+	ASSERT_EQ(ws_read_text(all, buf, sizeof(buf)), 2);
+	ASSERT_EQ(ws_read_text(eth1, buf, sizeof(buf)), 2);
+	
+	/* A new name reaches every CBOR client, matching or not */
+	make_event(&event, "eth0", 1);
+	ASSERT_EQ(web_stream_publish(test_stream, &event, "eth0-event", 10), 2);
+	ASSERT_EQ(ws_read_text(text, buf, sizeof(buf)), 10);
+	ASSERT_EQ(ws_read_frame(all, 0x2, buf, sizeof(buf)), 8);
+	ASSERT_TRUE(memcmp(buf, eth0_definition, 8) == 0);
+	ASSERT_EQ(ws_read_frame(all, 0x2, buf, sizeof(buf)), 9);
+	ASSERT_EQ((unsigned char)buf[0], 0x88);
+	ASSERT_EQ(buf[1], EVENT_CBOR_EVENT);
+	ASSERT_EQ(buf[6], 0);
+	ASSERT_EQ(ws_read_frame(eth1, 0x2, buf, sizeof(buf)), 8);
+	ASSERT_TRUE(memcmp(buf, eth0_definition, 8) == 0);
+	ASSERT_TRUE(ws_quiet(eth1));
+	
+	/* Known names go as their index only */
+	ASSERT_EQ(web_stream_publish(test_stream, &event, "eth0-event", 10), 2);
+	ASSERT_EQ(ws_read_text(text, buf, sizeof(buf)), 10);
+	ASSERT_EQ(ws_read_frame(all, 0x2, buf, sizeof(buf)), 9);
+	ASSERT_TRUE(ws_quiet(eth1));
+	
+	make_event(&event, "eth1", 2);
+	ASSERT_EQ(web_stream_publish(test_stream, &event, "eth1-event", 10), 3);
+	ASSERT_EQ(ws_read_text(text, buf, sizeof(buf)), 10);
+	ASSERT_EQ(ws_read_frame(eth1, 0x2, buf, sizeof(buf)), 8);
+	ASSERT_TRUE(memcmp(buf, eth1_definition, 8) == 0);
+	ASSERT_EQ(ws_read_frame(eth1, 0x2, buf, sizeof(buf)), 9);
+	ASSERT_EQ(buf[6], 1);
+	
+	/* A client joining later learns the names in use first */
+	late = ws_connect_protocol(TEST_PORT + 1, EVENT_CBOR_SUBPROTOCOL);
+	ASSERT_TRUE(late >= 0);
+	ASSERT_TRUE(ws_send_text(late, ""));
+	ASSERT_EQ(ws_read_frame(late, 0x2, buf, sizeof(buf)), 16);
+	ASSERT_TRUE(memcmp(buf, eth0_definition, 8) == 0);
+	ASSERT_TRUE(memcmp(buf + 8, eth1_definition, 8) == 0);
+	ASSERT_EQ(ws_read_text(late, buf, sizeof(buf)), 2);
+	
+	close(text);
+	close(all);
+	close(eth1);
+	close(late);
+	websocket_server_cleanup(server);
+	web_stream_destroy(test_stream);
+	test_stream = NULL;
+}
+
+TEST_SUITE_BEGIN("Web Stream")
+	RUN_TEST(stream_groups_shared);
+	RUN_TEST(stream_invalid_filter);
+	RUN_TEST(stream_sse_read);
+	RUN_TEST(stream_websocket_filtered);
+	RUN_TEST(stream_websocket_cbor);
+TEST_SUITE_END()
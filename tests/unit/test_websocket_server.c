@@ -0,0 +1,604 @@
+/* test_websocket_server.c - Unit tests for the WebSocket server */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "test_framework.h"
+#include "websocket_server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+
+#define TEST_PORT 19480
+#define MANY_CLIENTS 200
+
+static atomic_int connects, disconnects;
+static struct ws_connection *_Atomic last_conn;
+
+/* Echo every message back to its sender */
+static void echo_message(struct ws_connection *conn, const char *message, size_t len,
+                         void *user_data)
+{
+	(void)user_data;
+	
+	/* Messages are NUL terminated for the callback */
+	if (message[len] == '\0')
+		websocket_send(conn, message, len);
+}
+
+static void count_connect(struct ws_connection *conn, void *user_data)
+{
+	(void)user_data;
+	atomic_store(&last_conn, conn);
+	atomic_fetch_add(&connects, 1);
+}
+
+static void count_disconnect(struct ws_connection *conn, void *user_data)
+{
+	(void)conn;
+	(void)user_data;
+	atomic_fetch_add(&disconnects, 1);
+}
+
+static struct websocket_server *start_server(uint16_t port, unsigned int threads,
+                                             enum websocket_slow_client slow_client,
+                                             enum websocket_compression compression)
+{
+	struct websocket_config config = {
+		.port = port,
+		.on_message = echo_message,
+		.on_connect = count_connect,
+		.on_disconnect = count_disconnect,
+		.threads = threads,
+		.slow_client = slow_client,
+		.compression = compression,
+	};
+	struct websocket_server *server = websocket_server_init(&config);
+	
+	if (server && websocket_server_start(server) != 0) {
+		websocket_server_cleanup(server);
+		return NULL;
+	}
+	return server;
+}
+
+static int thread_count(void)
+{
+	char line[128];
+	int threads = -1;
+	FILE *fp = fopen("/proc/self/status", "r");
+	
+	if (!fp)
+		return -1;
+	while (fgets(line, sizeof(line), fp))
+		if (sscanf(line, "Threads: %d", &threads) == 1)
+			break;
+	fclose(fp);
+	return threads;
+}
+
+/* Wait up to two seconds for the server to report count connections */
+static bool wait_connections(struct websocket_server *server, int count)
+{
+	for (int i = 0; i < 200; i++) {
+		if (websocket_get_connection_count(server) == count)
+			return true;
+		usleep(10000);
+	}
+	return false;
+}
+
+/* Wait up to two seconds for the connect callback to have run count times */
+static bool wait_connects(int count)
+{
+	for (int i = 0; i < 200; i++) {
+		if (atomic_load(&connects) == count)
+			return true;
+		usleep(10000);
+	}
+	return false;
+}
+
+/* Connect and complete the upgrade offering the extensions, if any.
+ * Returns the socket or -1, the response headers in response. */
+static int ws_connect_with(uint16_t port, const char *extensions, char *response, size_t size)
+{
+	struct timeval tv = { .tv_sec = 2 };
+	struct sockaddr_in addr;
+	char request[512];
+	size_t len = 0;
+	int one = 1;
+	int sock;
+	
+	snprintf(request, sizeof(request),
+		 "GET /ws HTTP/1.1\r\n"
+		 "Host: localhost\r\n"
+		 "Upgrade: websocket\r\n"
+		 "Connection: Upgrade\r\n"
+		 "sec-websocket-key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+		 "%s%s%s"
+		 "Sec-WebSocket-Version: 13\r\n"
+		 "\r\n",
+		 extensions ? "Sec-WebSocket-Extensions: " : "",
+		 extensions ? extensions : "", extensions ? "\r\n" : "");
+	
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0)
+		return -1;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    send(sock, request, strlen(request), 0) < 0)
+		goto fail;
+	
+	/* Read exactly the response headers, frames may follow */
+	while (len < size - 1) {
+		if (recv(sock, response + len, 1, 0) != 1)
+			goto fail;
+		len++;
+		response[len] = '\0';
+		if (len >= 4 && strcmp(response + len - 4, "\r\n\r\n") == 0)
+			break;
+	}
+	
+	if (strncmp(response, "HTTP/1.1 101", 12) != 0 ||
+	    !strstr(response, "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"))
+		goto fail;
+	
+	return sock;
+	
+fail:
+	close(sock);
+	return -1;
+}
+
+static int ws_connect(uint16_t port)
+{
+	char response[512];
+	
+	return ws_connect_with(port, NULL, response, sizeof(response));
+}
+
+/* Build a masked client frame, returns its length */
+static size_t ws_frame(unsigned char *frame, bool fin, int opcode, const char *data, size_t len)
+{
+	static const unsigned char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+	size_t pos = 2;
+	
+	frame[0] = (fin ? 0x80 : 0) | (opcode & 0x4f);
+	if (len < 126) {
+		frame[1] = 0x80 | len;
+	} else {
+		frame[1] = 0x80 | 126;
+		frame[2] = len >> 8;
+		frame[3] = len & 0xff;
+		pos = 4;
+	}
+	memcpy(frame + pos, mask, 4);
+	pos += 4;
+	for (size_t i = 0; i < len; i++)
+		frame[pos + i] = data[i] ^ mask[i % 4];
+	return pos + len;
+}
+
+static bool recv_all(int sock, unsigned char *buf, size_t len)
+{
+	size_t got = 0;
+	
+	while (got < len) {
+		ssize_t n = recv(sock, buf + got, len - got, 0);
+		if (n <= 0)
+			return false;
+		got += (size_t)n;
+	}
+	return true;
+}
+
+/* Read one server frame, returns the payload length or -1. The opcode
+ * has 0x40 set for a compressed message. */
+static ssize_t ws_read(int sock, int *opcode, char *buf, size_t size)
+{
+	unsigned char header[10];
+	size_t len;
+	
+	if (!recv_all(sock, header, 2))
+		return -1;
+	*opcode = header[0] & 0x4f;
+	len = header[1] & 0x7f;
+	if (len == 126) {
+		if (!recv_all(sock, header + 2, 2))
+			return -1;
+		len = (header[2] << 8) | header[3];
+	} else if (len == 127) {
+		if (!recv_all(sock, header + 2, 8))
+			return -1;
+		len = 0;
+		for (int i = 0; i < 8; i++)
+			len = (len << 8) | header[2 + i];
+	}
+	if (len >= size || !recv_all(sock, (unsigned char *)buf, len))
+		return -1;
+	buf[len] = '\0';
+	return (ssize_t)len;
+}
+
+TEST(websocket_partial_frames)
+{
+	struct websocket_server *server = start_server(TEST_PORT, 1, WS_SLOW_CLIENT_DROP, WS_COMPRESSION_OFF);
+	unsigned char frame[512];
+	char buf[512];
+	size_t len;
+	int opcode;
+	int sock;
+	
+	ASSERT_NOT_NULL(server);
+	sock = ws_connect(TEST_PORT);
+	ASSERT_TRUE(sock >= 0);
+	
+	/* A frame trickling in one byte at a time */
+	len = ws_frame(frame, true, 0x1, "hello, world", 12);
+	for (size_t i = 0; i < len; i++) {
+		ASSERT_EQ(send(sock, frame + i, 1, 0), 1);
+		usleep(1000);
+	}
+	ASSERT_EQ(ws_read(sock, &opcode, buf, sizeof(buf)), 12);
+	ASSERT_EQ(opcode, 0x1);
+	ASSERT_STR_EQ(buf, "hello, world");
+	
+	/* Two frames in one segment, the second with a 16-bit length */
+	char big[300];
+	memset(big, 'x', sizeof(big));
+	len = ws_frame(frame, true, 0x1, "one", 3);
+	len += ws_frame(frame + len, true, 0x1, big, sizeof(big));
+	ASSERT_EQ(send(sock, frame, len, 0), (ssize_t)len);
+	ASSERT_EQ(ws_read(sock, &opcode, buf, sizeof(buf)), 3);
+	ASSERT_STR_EQ(buf, "one");
+	ASSERT_EQ(ws_read(sock, &opcode, buf, sizeof(buf)), (ssize_t)sizeof(big));
+	ASSERT_EQ(buf[299], 'x');
+	
+	close(sock);
+	websocket_server_cleanup(server);
+}
+
+TEST(websocket_fragments_and_control)
+{
+	struct websocket_server *server = start_server(TEST_PORT + 1, 1, WS_SLOW_CLIENT_DROP, WS_COMPRESSION_OFF);
+	unsigned char frame[512];
+	char buf[512];
+	size_t len;
+	int opcode;
+	int sock;
+	
+	ASSERT_NOT_NULL(server);
+	sock = ws_connect(TEST_PORT + 1);
+	ASSERT_TRUE(sock >= 0);
+	
+	/* A fragmented message with a ping between the fragments */
+	len = ws_frame(frame, false, 0x1, "frag", 4);
+	len += ws_frame(frame + len, true, 0x9, "p", 1);
+	len += ws_frame(frame + len, true, 0x0, "ment", 4);
+	ASSERT_EQ(send(sock, frame, len, 0), (ssize_t)len);
+	
+	ASSERT_EQ(ws_read(sock, &opcode, buf, sizeof(buf)), 1);
+	ASSERT_EQ(opcode, 0xA);
+	ASSERT_STR_EQ(buf, "p");
+	ASSERT_EQ(ws_read(sock, &opcode, buf, sizeof(buf)), 8);
+	ASSERT_EQ(opcode, 0x1);
+	ASSERT_STR_EQ(buf, "fragment");
+	
+	/* Close is echoed and the server hangs up */
+	len = ws_frame(frame, true, 0x8, "\x03\xe8", 2);
+	ASSERT_EQ(send(sock, frame, len, 0), (ssize_t)len);
+	ASSERT_EQ(ws_read(sock, &opcode, buf, sizeof(buf)), 2);
+	ASSERT_EQ(opcode, 0x8);
+	ASSERT_EQ(recv(sock, buf, 1, 0), 0);
+	close(sock);
+	ASSERT_TRUE(wait_connections(server, 0));
+	
+	websocket_server_cleanup(server);
+}
+
+TEST(websocket_many_clients)
+{
+	int before = thread_count();
+	int connected = atomic_load(&connects);
+	int disconnected = atomic_load(&disconnects);
+	struct websocket_server *server = start_server(TEST_PORT + 2, 2, WS_SLOW_CLIENT_DROP, WS_COMPRESSION_OFF);
+	static int socks[MANY_CLIENTS];
+	char buf[64];
+	int opcode;
+	
+	ASSERT_NOT_NULL(server);
+	for (int i = 0; i < MANY_CLIENTS; i++) {
+		socks[i] = ws_connect(TEST_PORT + 2);
+		ASSERT_TRUE(socks[i] >= 0);
+	}
+	ASSERT_TRUE(wait_connections(server, MANY_CLIENTS));
+	ASSERT_TRUE(wait_connects(connected + MANY_CLIENTS));
+	
+	/* Thread count does not grow with the clients */
+	ASSERT_EQ(thread_count(), before + 2);
+	
+	ASSERT_EQ(websocket_broadcast(server, "{\"event\":1}", 11), 0);
+	for (int i = 0; i < MANY_CLIENTS; i++) {
+		ASSERT_EQ(ws_read(socks[i], &opcode, buf, sizeof(buf)), 11);
+		ASSERT_STR_EQ(buf, "{\"event\":1}");
+	}
+	
+	for (int i = 0; i < MANY_CLIENTS; i++)
+		close(socks[i]);
+	ASSERT_TRUE(wait_connections(server, 0));
+	ASSERT_EQ(atomic_load(&disconnects) - disconnected, MANY_CLIENTS);
+	
+	websocket_server_cleanup(server);
+	ASSERT_EQ(thread_count(), before);
+}
+
+TEST(websocket_slow_client_dropped)
+{
+	struct websocket_server *server = start_server(TEST_PORT + 3, 1, WS_SLOW_CLIENT_DROP, WS_COMPRESSION_OFF);
+	struct websocket_stats stats;
+	int rcvbuf = 4096;
+	char *message;
+	int sock;
+	
+	ASSERT_NOT_NULL(server);
+	sock = ws_connect(TEST_PORT + 3);
+	ASSERT_TRUE(sock >= 0);
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	ASSERT_TRUE(wait_connections(server, 1));
+	
+	/* The client never reads, broadcasts must not block on it */
+	message = malloc(64 * 1024);
+	ASSERT_NOT_NULL(message);
+	memset(message, 'a', 64 * 1024);
+	for (int i = 0; i < 200; i++)
+		ASSERT_EQ(websocket_broadcast(server, message, 64 * 1024), 0);
+	free(message);
+	
+	ASSERT_TRUE(wait_connections(server, 0));
+	websocket_get_stats(server, &stats);
+	ASSERT_EQ(stats.broadcasts, 200);
+	ASSERT_EQ(stats.clients_dropped, 1);
+	ASSERT_EQ(stats.frames_skipped, 0);
+	
+	close(sock);
+	websocket_server_cleanup(server);
+}
+
+TEST(websocket_slow_client_skips)
+{
+	struct websocket_server *server = start_server(TEST_PORT + 4, 1, WS_SLOW_CLIENT_SKIP, WS_COMPRESSION_OFF);
+	struct websocket_stats stats;
+	static char message[64 * 1024];
+	static char buf[64 * 1024 + 1];
+	int last = -1;
+	int opcode;
+	int sock;
+	
+	ASSERT_NOT_NULL(server);
+	sock = ws_connect(TEST_PORT + 4);
+	ASSERT_TRUE(sock >= 0);
+	ASSERT_TRUE(wait_connections(server, 1));
+	
+	/* The client does not read until the socket and its queue are full */
+	memset(message, 'a', sizeof(message));
+	for (int i = 0; i < 400; i++) {
+		snprintf(message, 8, "%06d", i);
+		ASSERT_EQ(websocket_broadcast(server, message, sizeof(message)), 0);
+	}
+	
+	/* The client stays and misses some broadcasts */
+	websocket_get_stats(server, &stats);
+	ASSERT_EQ(stats.connections, 1);
+	ASSERT_EQ(stats.clients_dropped, 0);
+	ASSERT_TRUE(stats.frames_skipped > 0);
+	
+	/* What it gets are whole frames, in order, up to the newest */
+	while (last < 399) {
+		ASSERT_EQ(ws_read(sock, &opcode, buf, sizeof(buf)), (ssize_t)sizeof(message));
+		ASSERT_TRUE(atoi(buf) > last);
+		ASSERT_EQ(buf[sizeof(message) - 1], 'a');
+		last = atoi(buf);
+	}
+	
+	close(sock);
+	websocket_server_cleanup(server);
+}
+
+/* Inflate a compressed message the way a client does, returns its length */
+static ssize_t client_inflate(z_stream *zs, const char *data, size_t len, char *out, size_t size)
+{
+	static const unsigned char tail[4] = { 0x00, 0x00, 0xff, 0xff };
+	unsigned char *in = malloc(len + 4);
+	int ret;
+	
+	if (!in)
+		return -1;
+	memcpy(in, data, len);
+	memcpy(in + len, tail, 4);
+	zs->next_in = in;
+	zs->avail_in = len + 4;
+	zs->next_out = (unsigned char *)out;
+	zs->avail_out = size - 1;
+	ret = inflate(zs, Z_SYNC_FLUSH);
+	free(in);
+	if (ret != Z_OK || zs->avail_in)
+		return -1;
+	out[size - 1 - zs->avail_out] = '\0';
+	return (ssize_t)(size - 1 - zs->avail_out);
+}
+
+/* Repetitive event JSON, like the dashboard streams */
+static size_t event_json(char *buf, size_t size, int seq)
+{
+	size_t len = 0;
+	
+	for (int i = 0; i < 8; i++)
+		len += snprintf(buf + len, size - len,
+				"{\"type\":\"event\",\"seq\":%d,\"interface\":\"eth0\","
+				"\"message_type\":\"RTM_NEWLINK\",\"flags\":\"UP,RUNNING\"}",
+				seq * 8 + i);
+	return len;
+}
+
+TEST(websocket_deflate_context)
+{
+	struct websocket_server *server = start_server(TEST_PORT + 5, 1, WS_SLOW_CLIENT_DROP,
+						       WS_COMPRESSION_CONTEXT);
+	struct websocket_connection_stats conn_stats;
+	struct websocket_stats stats;
+	z_stream client_in, client_out;
+	unsigned char frame[2048], packed[1024];
+	char message[1024], buf[2048], plain[2048];
+	size_t len, first = 0;
+	ssize_t n;
+	int opcode;
+	int sock;
+	
+	ASSERT_NOT_NULL(server);
+	int connected = atomic_load(&connects);
+	sock = ws_connect_with(TEST_PORT + 5, "permessage-deflate; client_max_window_bits",
+			       buf, sizeof(buf));
+	ASSERT_TRUE(sock >= 0);
+	ASSERT_TRUE(strstr(buf, "Sec-WebSocket-Extensions: permessage-deflate\r\n") != NULL);
+	ASSERT_TRUE(wait_connects(connected + 1));
+	
+	memset(&client_in, 0, sizeof(client_in));
+	ASSERT_EQ(inflateInit2(&client_in, -15), Z_OK);
+	
+	/* Each broadcast is compressed against the ones before it */
+	for (int i = 0; i < 3; i++) {
+		len = event_json(message, sizeof(message), i);
+		ASSERT_EQ(websocket_broadcast(server, message, len), 0);
+		n = ws_read(sock, &opcode, buf, sizeof(buf));
+		ASSERT_TRUE(n > 0 && (size_t)n < len);
+		ASSERT_EQ(opcode, 0x41);
+		if (i == 0)
+			first = (size_t)n;
+		else
+			ASSERT_TRUE((size_t)n < first);
+		ASSERT_EQ(client_inflate(&client_in, buf, n, plain, sizeof(plain)), (ssize_t)len);
+		ASSERT_STR_EQ(plain, message);
+	}
+	
+	/* Short messages go out as they are */
+	ASSERT_EQ(websocket_broadcast(server, "{}", 2), 0);
+	ASSERT_EQ(ws_read(sock, &opcode, buf, sizeof(buf)), 2);
+	ASSERT_EQ(opcode, 0x1);
+	
+	/* A compressed client message is inflated for the callback and the
+	 * echo compressed in the same context */
+	memset(&client_out, 0, sizeof(client_out));
+	ASSERT_EQ(deflateInit2(&client_out, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY), Z_OK);
+	len = event_json(message, sizeof(message), 3);
+	client_out.next_in = (unsigned char *)message;
+	client_out.avail_in = len;
+	client_out.next_out = packed;
+	client_out.avail_out = sizeof(packed);
+	ASSERT_EQ(deflate(&client_out, Z_SYNC_FLUSH), Z_OK);
+	size_t packed_len = sizeof(packed) - client_out.avail_out - 4;
+	deflateEnd(&client_out);
+	
+	size_t frame_len = ws_frame(frame, true, 0x41, (char *)packed, packed_len);
+	ASSERT_EQ(send(sock, frame, frame_len, 0), (ssize_t)frame_len);
+	n = ws_read(sock, &opcode, buf, sizeof(buf));
+	ASSERT_TRUE(n > 0);
+	ASSERT_EQ(opcode, 0x41);
+	ASSERT_EQ(client_inflate(&client_in, buf, n, plain, sizeof(plain)), (ssize_t)len);
+	ASSERT_STR_EQ(plain, message);
+	inflateEnd(&client_in);
+	
+	ASSERT_EQ(websocket_get_connection_stats(atomic_load(&last_conn), &conn_stats), 0);
+	ASSERT_EQ(conn_stats.compressed, 1);
+	ASSERT_EQ(conn_stats.messages_compressed, 4);
+	ASSERT_TRUE(conn_stats.bytes_compressed * 4 < conn_stats.bytes_uncompressed);
+	websocket_get_stats(server, &stats);
+	ASSERT_EQ(stats.messages_compressed, 4);
+	ASSERT_EQ(stats.bytes_compressed, conn_stats.bytes_compressed);
+	
+	close(sock);
+	websocket_server_cleanup(server);
+}
+
+TEST(websocket_deflate_shared)
+{
+	struct websocket_server *server = start_server(TEST_PORT + 6, 2, WS_SLOW_CLIENT_DROP,
+						       WS_COMPRESSION_SHARED);
+	struct websocket_stats stats;
+	char message[1024], buf[2][2048], plain[2048];
+	ssize_t n[2];
+	size_t len;
+	int socks[3];
+	int opcode;
+	
+	ASSERT_NOT_NULL(server);
+	int connected = atomic_load(&connects);
+	for (int i = 0; i < 2; i++) {
+		socks[i] = ws_connect_with(TEST_PORT + 6, "x-unknown, permessage-deflate",
+					   buf[0], sizeof(buf[0]));
+		ASSERT_TRUE(socks[i] >= 0);
+		ASSERT_TRUE(strstr(buf[0], "permessage-deflate; server_no_context_takeover\r\n") != NULL);
+	}
+	
+	/* A window the shared compressor cannot honour is declined */
+	socks[2] = ws_connect_with(TEST_PORT + 6, "permessage-deflate; server_max_window_bits=10",
+				   buf[0], sizeof(buf[0]));
+	ASSERT_TRUE(socks[2] >= 0);
+	ASSERT_TRUE(strstr(buf[0], "Sec-WebSocket-Extensions") == NULL);
+	ASSERT_TRUE(wait_connects(connected + 3));
+	
+	/* Both compressed clients get the same bytes, each message inflates on its own */
+	for (int i = 0; i < 2; i++) {
+		len = event_json(message, sizeof(message), i);
+		ASSERT_EQ(websocket_broadcast(server, message, len), 0);
+		for (int c = 0; c < 2; c++) {
+			n[c] = ws_read(socks[c], &opcode, buf[c], sizeof(buf[c]));
+			ASSERT_EQ(opcode, 0x41);
+		}
+		ASSERT_EQ(n[0], n[1]);
+		ASSERT_TRUE(memcmp(buf[0], buf[1], n[0]) == 0);
+		
+		z_stream client_in;
+		memset(&client_in, 0, sizeof(client_in));
+		ASSERT_EQ(inflateInit2(&client_in, -15), Z_OK);
+		ASSERT_EQ(client_inflate(&client_in, buf[0], n[0], plain, sizeof(plain)), (ssize_t)len);
+		ASSERT_STR_EQ(plain, message);
+		inflateEnd(&client_in);
+		
+		ASSERT_EQ(ws_read(socks[2], &opcode, buf[0], sizeof(buf[0])), (ssize_t)len);
+		ASSERT_EQ(opcode, 0x1);
+	}
+	
+	websocket_get_stats(server, &stats);
+	ASSERT_EQ(stats.messages_compressed, 4);
+	
+	for (int i = 0; i < 3; i++)
+		close(socks[i]);
+	websocket_server_cleanup(server);
+}
+
+TEST_SUITE_BEGIN("WebSocket Server")
+	RUN_TEST(websocket_partial_frames);
+	RUN_TEST(websocket_fragments_and_control);
+	RUN_TEST(websocket_many_clients);
+	RUN_TEST(websocket_slow_client_dropped);
+	RUN_TEST(websocket_slow_client_skips);
+	RUN_TEST(websocket_deflate_context);
+	RUN_TEST(websocket_deflate_shared);
+TEST_SUITE_END()
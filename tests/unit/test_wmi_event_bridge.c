@@ -0,0 +1,145 @@
+/* test_wmi_event_bridge.c - Unit tests for the WMI event bridge */
+
+#include "test_framework.h"
+#include "wmi_event_bridge.h"
+#include "event_processor.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_SOURCES 3
+#define TEST_SOURCE_LINES 500
+
+/* Per-source view of the events handled */
+struct seen {
+	pthread_mutex_t lock;
+	unsigned long count[TEST_SOURCES + 1];
+	uint64_t last_seq[TEST_SOURCES + 1];
+	int out_of_order;
+};
+
+static struct seen g_seen = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void record_event(struct nlmon_event *event, void *ctx)
+{
+	const struct wmi_event_metadata *metadata = event->data;
+	struct seen *seen = ctx;
+	
+	if (!metadata || metadata->source_id > TEST_SOURCES)
+		return;
+	
+	pthread_mutex_lock(&seen->lock);
+	if (seen->count[metadata->source_id] > 0 &&
+	    metadata->source_seq <= seen->last_seq[metadata->source_id])
+		seen->out_of_order++;
+	seen->last_seq[metadata->source_id] = metadata->source_seq;
+	seen->count[metadata->source_id]++;
+	pthread_mutex_unlock(&seen->lock);
+}
+
+static void write_source(const char *path, int lines)
+{
+	FILE *fp = fopen(path, "w");
+	
+	for (int i = 0; i < lines; i++)
+		fprintf(fp, "[0x%x] Send WMI command:WMI_VDEV_UP_CMDID command_id:20482 htc_tag:1\n",
+		        i + 1);
+	fprintf(fp, "not a wmi line\n");
+	fclose(fp);
+}
+
+static unsigned long seen_total(void)
+{
+	unsigned long total = 0;
+	
+	pthread_mutex_lock(&g_seen.lock);
+	for (int i = 0; i <= TEST_SOURCES; i++)
+		total += g_seen.count[i];
+	pthread_mutex_unlock(&g_seen.lock);
+	return total;
+}
+
+TEST(bridge_multiple_sources)
+{
+	struct event_processor_config config;
+	struct wmi_bridge_config bridge_config = {0};
+	struct wmi_bridge_source_stats stats;
+	struct event_processor *ep;
+	char paths[TEST_SOURCES][64];
+	int ids[TEST_SOURCES];
+	
+	memset(&config, 0, sizeof(config));
+	config.ring_buffer_size = 4096;
+	config.thread_pool_size = 2;
+	config.overload_policy = EVENT_OVERLOAD_BLOCK;
+	config.overload_timeout_ms = 1000;
+	ep = event_processor_create(&config);
+	ASSERT_NOT_NULL(ep);
+	ASSERT_TRUE(event_processor_register_handler(ep, record_event, &g_seen) >= 0);
+	
+	bridge_config.event_processor = ep;
+	ASSERT_EQ(wmi_bridge_init(&bridge_config), 0);
+	
+	/* One log per radio, each read on its own thread */
+	for (int i = 0; i < TEST_SOURCES; i++) {
+		snprintf(paths[i], sizeof(paths[i]), "/tmp/test_unit_wmi_bridge_%d.log", i);
+		write_source(paths[i], TEST_SOURCE_LINES * (i + 1));
+		ids[i] = wmi_bridge_add_source(paths[i], 0);
+		ASSERT_TRUE(ids[i] >= 1 && ids[i] <= WMI_BRIDGE_MAX_SOURCES);
+	}
+	ASSERT_EQ(wmi_bridge_add_source("/tmp/test_unit_wmi_bridge_missing.log", 0), -2);
+	
+	/* Sources end at their end of file */
+	for (int i = 0; i < TEST_SOURCES; i++) {
+		for (int wait = 0; wait < 500; wait++) {
+			ASSERT_EQ(wmi_bridge_get_source_stats(ids[i], &stats), 0);
+			if (!stats.running)
+				break;
+			usleep(10000);
+		}
+		ASSERT_FALSE(stats.running);
+		ASSERT_EQ(stats.source_id, (uint32_t)ids[i]);
+		ASSERT_STR_EQ(stats.log_source, paths[i]);
+		ASSERT_EQ(stats.lines_read, TEST_SOURCE_LINES * (i + 1) + 1);
+		ASSERT_EQ(stats.entries, TEST_SOURCE_LINES * (i + 1));
+		ASSERT_EQ(stats.entries_submitted, stats.entries);
+	}
+	
+	for (int wait = 0; wait < 500 && seen_total() < 6 * TEST_SOURCE_LINES; wait++)
+		usleep(10000);
+	
+	/* Every source arrives whole and in its own order */
+	for (int i = 0; i < TEST_SOURCES; i++)
+		ASSERT_EQ(g_seen.count[ids[i]], TEST_SOURCE_LINES * (i + 1));
+	ASSERT_EQ(g_seen.out_of_order, 0);
+	ASSERT_EQ(wmi_bridge_get_source_stats(0, &stats), -1);
+	
+	wmi_bridge_cleanup();
+	event_processor_destroy(ep, true);
+	for (int i = 0; i < TEST_SOURCES; i++)
+		unlink(paths[i]);
+}
+
+TEST(bridge_batch_without_processor)
+{
+	struct wmi_bridge_config bridge_config = {0};
+	struct wmi_log_entry entries[WMI_BRIDGE_BATCH_SIZE * 2 + 3];
+	uint64_t converted = 0;
+	
+	memset(entries, 0, sizeof(entries));
+	ASSERT_EQ(wmi_bridge_submit_batch(entries, 1), -1);
+	ASSERT_EQ(wmi_bridge_init(&bridge_config), 0);
+	
+	ASSERT_EQ(wmi_bridge_submit_batch(entries, WMI_BRIDGE_BATCH_SIZE * 2 + 3),
+	          WMI_BRIDGE_BATCH_SIZE * 2 + 3);
+	ASSERT_EQ(wmi_bridge_get_stats(&converted, NULL, NULL), 0);
+	ASSERT_EQ(converted, WMI_BRIDGE_BATCH_SIZE * 2 + 3);
+	
+	wmi_bridge_cleanup();
+}
+
+TEST_SUITE_BEGIN("WMI Event Bridge")
+	RUN_TEST(bridge_multiple_sources);
+	RUN_TEST(bridge_batch_without_processor);
+TEST_SUITE_END()
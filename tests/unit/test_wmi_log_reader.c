@@ -0,0 +1,114 @@
+/* test_wmi_log_reader.c - Unit tests for WMI log readers driven by a loop */
+
+#include "test_framework.h"
+#include "wmi_log_reader.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_LOG "/tmp/test_unit_wmi_log_reader.log"
+
+static int lines;
+static int flushes;
+
+static int count_line(const char *line, void *user_data)
+{
+	lines++;
+	return 0;
+}
+
+static void count_flush(void *user_data)
+{
+	flushes++;
+}
+
+static void append(const char *path, const char *mode, int count)
+{
+	FILE *f = fopen(path, mode);
+	
+	for (int i = 0; f && i < count; i++)
+		fprintf(f, "line %d\n", i);
+	if (f)
+		fclose(f);
+}
+
+static struct wmi_log_reader *open_reader(int follow)
+{
+	struct wmi_log_config config;
+	
+	memset(&config, 0, sizeof(config));
+	config.log_source = TEST_LOG;
+	config.follow_mode = follow;
+	config.callback = count_line;
+	config.flush = count_flush;
+	lines = flushes = 0;
+	return wmi_log_reader_create(&config);
+}
+
+/* Poll until the reader waits or is done */
+static int poll_all(struct wmi_log_reader *reader)
+{
+	int ret;
+	
+	while ((ret = wmi_log_reader_poll(reader)) == WMI_LOG_POLL_MORE)
+		;
+	return ret;
+}
+
+TEST(poll_reads_file_to_its_end)
+{
+	struct wmi_log_reader *reader;
+	int interval_ms, polls = 0, ret;
+	
+	/* More than one poll's worth, the caller gets to run in between */
+	append(TEST_LOG, "w", 200000);
+	reader = open_reader(0);
+	ASSERT_NOT_NULL(reader);
+	ASSERT_EQ(wmi_log_reader_watch(reader, &interval_ms), -1);
+	ASSERT_EQ(interval_ms, 0);
+	
+	while ((ret = wmi_log_reader_poll(reader)) == WMI_LOG_POLL_MORE)
+		polls++;
+	ASSERT_EQ(ret, WMI_LOG_POLL_DONE);
+	ASSERT_TRUE(polls > 0);
+	ASSERT_EQ(lines, 200000);
+	ASSERT_TRUE(flushes > 0);
+	
+	wmi_log_reader_destroy(reader);
+	unlink(TEST_LOG);
+}
+
+TEST(poll_follows_appends_and_rotation)
+{
+	struct wmi_log_reader *reader;
+	int interval_ms;
+	
+	append(TEST_LOG, "w", 3);
+	reader = open_reader(1);
+	ASSERT_NOT_NULL(reader);
+	wmi_log_reader_watch(reader, &interval_ms);
+	ASSERT_TRUE(interval_ms > 0);
+	
+	ASSERT_EQ(poll_all(reader), WMI_LOG_POLL_WAIT);
+	ASSERT_EQ(lines, 3);
+	ASSERT_EQ(poll_all(reader), WMI_LOG_POLL_WAIT);
+	ASSERT_EQ(lines, 3);
+	
+	append(TEST_LOG, "a", 2);
+	ASSERT_EQ(poll_all(reader), WMI_LOG_POLL_WAIT);
+	ASSERT_EQ(lines, 5);
+	
+	/* A rotated file is read from its start */
+	unlink(TEST_LOG);
+	append(TEST_LOG, "w", 4);
+	ASSERT_EQ(poll_all(reader), WMI_LOG_POLL_WAIT);
+	ASSERT_EQ(lines, 9);
+	
+	wmi_log_reader_destroy(reader);
+	unlink(TEST_LOG);
+}
+
+TEST_SUITE_BEGIN("WMI Log Reader Polling")
+	RUN_TEST(poll_reads_file_to_its_end);
+	RUN_TEST(poll_follows_appends_and_rotation);
+TEST_SUITE_END()
@@ -0,0 +1,161 @@
+/* test_wmi_replay.c - Unit tests for parallel WMI log replay */
+
+#include "test_framework.h"
+#include "wmi_replay.h"
+#include "wmi_error.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_REPLAY_LOG "/tmp/test_unit_wmi_replay.log"
+#define TEST_LINES 2000
+
+struct collected {
+	uint64_t timestamps[TEST_LINES + 16];
+	unsigned int cmd_ids[TEST_LINES + 16];
+	size_t count;
+};
+
+static int collect_sink(const struct wmi_log_entry *entry, void *user_data)
+{
+	struct collected *out = user_data;
+	
+	if (out->count >= TEST_LINES + 16)
+		return -1;
+	out->timestamps[out->count] = entry->timestamp;
+	out->cmd_ids[out->count] = entry->cmd_id;
+	out->count++;
+	return 0;
+}
+
+/* Timestamps rising by 10 with neighbours swapped every 7 lines, and
+ * every 5th line sharing the timestamp of the one before */
+static uint64_t test_timestamp(int i)
+{
+	uint64_t ts = (uint64_t)i * 10 + 100;
+	
+	if (i % 7 == 0)
+		ts += 15;
+	else if (i % 7 == 1)
+		ts -= 15;
+	if (i % 5 == 4)
+		ts = test_timestamp(i - 1);
+	return ts;
+}
+
+static void write_test_log(void)
+{
+	FILE *fp = fopen(TEST_REPLAY_LOG, "w");
+	
+	for (int i = 1; i <= TEST_LINES; i++)
+		fprintf(fp, "[0x%llx] Send WMI command:WMI_VDEV_UP_CMDID command_id:%d htc_tag:1\n",
+		        (unsigned long long)test_timestamp(i), 0x5000 + i);
+	fclose(fp);
+}
+
+static int replay(unsigned int threads, size_t chunk_size, struct collected *out,
+                  struct wmi_replay_progress *result)
+{
+	struct wmi_replay_config config = {
+		.log_source = TEST_REPLAY_LOG,
+		.threads = threads,
+		.chunk_size = chunk_size,
+		.sink = collect_sink,
+		.user_data = out,
+	};
+	
+	out->count = 0;
+	return wmi_replay_run(&config, result);
+}
+
+TEST(replay_sorted_across_chunks)
+{
+	static struct collected out;
+	struct wmi_replay_progress result;
+	
+	write_test_log();
+	
+	/* A few lines per chunk, so swaps straddle chunk boundaries */
+	ASSERT_EQ(replay(4, 200, &out, &result), WMI_SUCCESS);
+	ASSERT_EQ(out.count, TEST_LINES);
+	ASSERT_EQ(result.entries, TEST_LINES);
+	ASSERT_EQ(result.lines, TEST_LINES);
+	ASSERT_EQ(result.parse_errors, 0);
+	ASSERT_EQ(result.sink_errors, 0);
+	ASSERT_EQ(result.bytes_parsed, result.bytes_total);
+	
+	for (size_t i = 1; i < out.count; i++) {
+		ASSERT_TRUE(out.timestamps[i - 1] <= out.timestamps[i]);
+		
+		/* Equal timestamps keep their file order */
+		if (out.timestamps[i - 1] == out.timestamps[i])
+			ASSERT_TRUE(out.cmd_ids[i - 1] < out.cmd_ids[i]);
+	}
+	
+	unlink(TEST_REPLAY_LOG);
+}
+
+TEST(replay_threads_agree)
+{
+	static struct collected single, multi;
+	
+	write_test_log();
+	
+	ASSERT_EQ(replay(1, 512, &single, NULL), WMI_SUCCESS);
+	ASSERT_EQ(replay(8, 512, &multi, NULL), WMI_SUCCESS);
+	ASSERT_EQ(single.count, multi.count);
+	ASSERT_EQ(memcmp(single.timestamps, multi.timestamps,
+	                 single.count * sizeof(single.timestamps[0])), 0);
+	ASSERT_EQ(memcmp(single.cmd_ids, multi.cmd_ids,
+	                 single.count * sizeof(single.cmd_ids[0])), 0);
+	
+	unlink(TEST_REPLAY_LOG);
+}
+
+TEST(replay_untimed_and_invalid_lines)
+{
+	static struct collected out;
+	struct wmi_replay_progress result;
+	FILE *fp = fopen(TEST_REPLAY_LOG, "w");
+	
+	fprintf(fp, "[0x30] Send WMI command:WMI_VDEV_UP_CMDID command_id:20482 htc_tag:1\r\n");
+	fprintf(fp, "Send WMI command:WMI_START_SCAN_CMDID command_id:36864 htc_tag:1\n");
+	fprintf(fp, "not a wmi line\n\n");
+	fprintf(fp, "[0x10] Send WMI command:WMI_VDEV_UP_CMDID command_id:20482 htc_tag:1");
+	fclose(fp);
+	
+	ASSERT_EQ(replay(2, 4096, &out, &result), WMI_SUCCESS);
+	ASSERT_EQ(result.lines, 4);
+	ASSERT_EQ(result.parse_errors, 1);
+	ASSERT_EQ(out.count, 3);
+	
+	/* The untimed entry stays behind the one before it */
+	ASSERT_EQ(out.timestamps[0], 0x10);
+	ASSERT_EQ(out.timestamps[1], 0x30);
+	ASSERT_EQ(out.cmd_ids[2], WMI_START_SCAN_CMDID);
+	
+	unlink(TEST_REPLAY_LOG);
+}
+
+TEST(replay_empty_and_missing)
+{
+	static struct collected out;
+	struct wmi_replay_progress result;
+	FILE *fp = fopen(TEST_REPLAY_LOG, "w");
+	
+	fclose(fp);
+	ASSERT_EQ(replay(0, 0, &out, &result), WMI_SUCCESS);
+	ASSERT_EQ(out.count, 0);
+	ASSERT_EQ(result.bytes_total, 0);
+	
+	unlink(TEST_REPLAY_LOG);
+	ASSERT_EQ(replay(0, 0, &out, NULL), WMI_ERR_FILE_NOT_FOUND);
+}
+
+TEST_SUITE_BEGIN("WMI Replay")
+	RUN_TEST(replay_sorted_across_chunks);
+	RUN_TEST(replay_threads_agree);
+	RUN_TEST(replay_untimed_and_invalid_lines);
+	RUN_TEST(replay_empty_and_missing);
+TEST_SUITE_END()